@@ -0,0 +1,437 @@
+/*++
+
+Copyright (c) Microsoft Corporation
+
+Module Name:
+
+    ToneBench.cpp
+
+Abstract:
+
+    A benchmark for the sine wave generator of the SYSVAD capture streams.
+
+    ToneGenerator::GenerateSine fills a buffer four frames at a time,
+    rotating the phase of each lane instead of calling sin() for every
+    frame, with the SSE2 or the scalar block routine. The benchmark times
+    both routines, and a sin() per frame loop like the one the generator
+    used before, for every format the sample supports over a range of
+    frame counts. It checks that each routine stays within one LSB of the
+    sin() loop.
+
+    ToneGenerator.cpp is built from the sysvad directory, so it runs the
+    same code the driver does. User mode threads always have their
+    floating point state saved, so the numbers leave out what
+    KeSaveFloatingPointState costs the driver for every call.
+
+
+Environment:
+
+    user mode only
+
+--*/
+
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_code_)
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ToneBench.h"
+#include "ToneGenerator.h"
+
+#define DEFAULT_MILLISECONDS    200
+
+#define TONE_FREQUENCY          1000
+#define TONE_RATE               48000
+
+//
+// Calls compared by the check; enough for the phase to wrap around and
+// for the partial frame of one call to be finished by the next.
+//
+#define CHECK_CALLS             5
+
+//
+// Largest difference, in LSBs, allowed between a routine and the sin()
+// loop. The lanes are rotated in single precision and a sample close to
+// an integer can truncate either way.
+//
+#define CHECK_TOLERANCE         1
+
+static const WORD   g_Bits[]        = { 8, 16 };
+static const WORD   g_Channels[]    = { 1, 2, 6, 8 };
+static const UINT32 g_FrameCounts[] = { 128, 441, 480, 4096 };
+
+typedef enum _BENCH_ROUTINE {
+    BenchRoutineSin,
+    BenchRoutineScalar,
+    BenchRoutineSse2,
+    BenchRoutineCount
+} BENCH_ROUTINE;
+
+static const char *g_RoutineNames[BenchRoutineCount] = { "Sin", "Scalar", "Sse2" };
+
+//
+// The sin() per frame loop, with the phase kept the way the generator
+// keeps it.
+//
+typedef struct _SIN_TONE {
+    double      Theta;
+    double      Increment;
+} SIN_TONE, *PSIN_TONE;
+
+LARGE_INTEGER g_Frequency;
+
+
+static
+VOID
+InitFormat(
+    _Out_ PWAVEFORMATEXTENSIBLE Format,
+    _In_ WORD Bits,
+    _In_ WORD Channels
+    )
+{
+    ZeroMemory(Format, sizeof(*Format));
+
+    Format->Format.wFormatTag = WAVE_FORMAT_PCM;
+    Format->Format.nChannels = Channels;
+    Format->Format.nSamplesPerSec = TONE_RATE;
+    Format->Format.wBitsPerSample = Bits;
+    Format->Format.nBlockAlign = (WORD)(Channels * Bits / 8);
+    Format->Format.nAvgBytesPerSec = TONE_RATE * Format->Format.nBlockAlign;
+}
+
+//
+// GenerateSin
+//
+// Fills whole frames with one sin() call each. The frame counts of the
+// benchmark are whole, so there is no partial frame to carry over.
+//
+static
+VOID
+GenerateSin(
+    _Inout_ PSIN_TONE Tone,
+    _In_ WORD Bits,
+    _In_ WORD Channels,
+    _Out_writes_bytes_(Frames * Channels * Bits / 8) BYTE *Buffer,
+    _In_ UINT32 Frames
+    )
+{
+    const double TwoPi = M_PI * 2;
+    double Value;
+    UINT32 f;
+    WORD c;
+
+    for (f = 0; f < Frames; f++) {
+        Value = 0.5 * sin(Tone->Theta);
+
+        for (c = 0; c < Channels; c++) {
+            if (Bits == 8) {
+                *Buffer++ = ConvertToUChar(Value);
+            } else {
+                *reinterpret_cast<short *>(Buffer) = ConvertToShort(Value);
+                Buffer += sizeof(short);
+            }
+        }
+
+        Tone->Theta += Tone->Increment;
+        if (Tone->Theta >= TwoPi) {
+            Tone->Theta -= TwoPi;
+        }
+    }
+}
+
+//
+// RunCall
+//
+// One GenerateSine call's worth of work with Routine.
+//
+static
+VOID
+RunCall(
+    _In_ BENCH_ROUTINE Routine,
+    _Inout_ ToneGenerator *Generator,
+    _Inout_ PSIN_TONE Tone,
+    _Out_writes_bytes_(Frames * Generator->m_FrameSize) BYTE *Buffer,
+    _In_ UINT32 Frames
+    )
+{
+    if (Routine == BenchRoutineSin) {
+        GenerateSin(Tone, Generator->m_BitsPerSample, Generator->m_ChannelCount, Buffer, Frames);
+    } else {
+        Generator->m_UseSse2 = (Routine == BenchRoutineSse2);
+        Generator->GenerateSine(Buffer, (size_t)Frames * Generator->m_FrameSize);
+    }
+}
+
+//
+// InitCase
+//
+// Sets up the generator, the sin() loop and a buffer for one case.
+//
+static
+BYTE *
+InitCase(
+    _Out_ ToneGenerator *Generator,
+    _Out_ PSIN_TONE Tone,
+    _In_ WORD Bits,
+    _In_ WORD Channels,
+    _In_ UINT32 Frames
+    )
+{
+    WAVEFORMATEXTENSIBLE Format;
+
+    InitFormat(&Format, Bits, Channels);
+
+    if (!NT_SUCCESS(Generator->Init(TONE_FREQUENCY, &Format))) {
+        return NULL;
+    }
+
+    Tone->Theta = 0.0;
+    Tone->Increment = Generator->m_SampleIncrement;
+
+    return (BYTE *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, (SIZE_T)Frames * Format.Format.nBlockAlign);
+}
+
+//
+// CheckRoutine
+//
+// Runs a few calls with Routine and with the sin() loop and compares the
+// samples. Returns the largest difference in LSBs, or a negative value if
+// the case can't be set up.
+//
+static
+int
+CheckRoutine(
+    _In_ BENCH_ROUTINE Routine,
+    _In_ WORD Bits,
+    _In_ WORD Channels,
+    _In_ UINT32 Frames
+    )
+{
+    ToneGenerator Expected;
+    ToneGenerator Actual;
+    SIN_TONE ExpectedTone;
+    SIN_TONE ActualTone;
+    BYTE *ExpectedBuffer;
+    BYTE *ActualBuffer;
+    UINT32 Samples = Frames * Channels;
+    UINT32 Call;
+    UINT32 i;
+    int Difference;
+    int Largest = 0;
+
+    ExpectedBuffer = InitCase(&Expected, &ExpectedTone, Bits, Channels, Frames);
+    ActualBuffer = InitCase(&Actual, &ActualTone, Bits, Channels, Frames);
+
+    if (ExpectedBuffer == NULL || ActualBuffer == NULL) {
+        Largest = -1;
+        goto Done;
+    }
+
+    for (Call = 0; Call < CHECK_CALLS; Call++) {
+        RunCall(BenchRoutineSin, &Expected, &ExpectedTone, ExpectedBuffer, Frames);
+        RunCall(Routine, &Actual, &ActualTone, ActualBuffer, Frames);
+
+        for (i = 0; i < Samples; i++) {
+            if (Bits == 8) {
+                Difference = (int)ExpectedBuffer[i] - (int)ActualBuffer[i];
+            } else {
+                Difference = (int)reinterpret_cast<short *>(ExpectedBuffer)[i] -
+                             (int)reinterpret_cast<short *>(ActualBuffer)[i];
+            }
+
+            Difference = abs(Difference);
+            if (Difference > Largest) {
+                Largest = Difference;
+            }
+        }
+    }
+
+Done:
+    if (ExpectedBuffer != NULL) {
+        HeapFree(GetProcessHeap(), 0, ExpectedBuffer);
+    }
+    if (ActualBuffer != NULL) {
+        HeapFree(GetProcessHeap(), 0, ActualBuffer);
+    }
+
+    return Largest;
+}
+
+//
+// TimeRoutine
+//
+// Returns the average time of a call in nanoseconds, or a negative value
+// if the case can't be set up.
+//
+static
+double
+TimeRoutine(
+    _In_ BENCH_ROUTINE Routine,
+    _In_ WORD Bits,
+    _In_ WORD Channels,
+    _In_ UINT32 Frames,
+    _In_ ULONG Milliseconds
+    )
+{
+    ToneGenerator Generator;
+    SIN_TONE Tone;
+    BYTE *Buffer;
+    LARGE_INTEGER Start;
+    LARGE_INTEGER Now;
+    LONGLONG Budget;
+    ULONGLONG Calls = 0;
+    UINT32 i;
+
+    Buffer = InitCase(&Generator, &Tone, Bits, Channels, Frames);
+    if (Buffer == NULL) {
+        return -1.0;
+    }
+
+    //
+    // Warm up the caches and the branch predictors.
+    //
+
+    for (i = 0; i < 16; i++) {
+        RunCall(Routine, &Generator, &Tone, Buffer, Frames);
+    }
+
+    Budget = g_Frequency.QuadPart * Milliseconds / 1000;
+
+    QueryPerformanceCounter(&Start);
+
+    do {
+        for (i = 0; i < 16; i++) {
+            RunCall(Routine, &Generator, &Tone, Buffer, Frames);
+        }
+        Calls += 16;
+
+        QueryPerformanceCounter(&Now);
+
+    } while (Now.QuadPart - Start.QuadPart < Budget);
+
+    HeapFree(GetProcessHeap(), 0, Buffer);
+
+    return (double)(Now.QuadPart - Start.QuadPart) * 1e9 / (double)g_Frequency.QuadPart / (double)Calls;
+}
+
+static
+VOID
+Usage()
+{
+    printf("Usage: ToneBench.exe [-Milliseconds <n>]\n");
+    printf("    -Milliseconds   time spent on each case (default %d)\n", DEFAULT_MILLISECONDS);
+}
+
+int __cdecl
+main(
+    _In_ int argc,
+    _In_reads_(argc) char* argv[]
+    )
+{
+    ULONG Milliseconds = DEFAULT_MILLISECONDS;
+    BOOL Present[BenchRoutineCount] = { TRUE, TRUE, FALSE };
+    int Argument;
+    int Failures = 0;
+    int Difference;
+    UINT32 b, c, f, r;
+    double Baseline;
+    double Time;
+
+    for (Argument = 1; Argument < argc; Argument++) {
+        if (_stricmp(argv[Argument], "-Milliseconds") == 0 && Argument + 1 < argc) {
+            Milliseconds = strtoul(argv[++Argument], NULL, 0);
+        } else {
+            Usage();
+            return 1;
+        }
+    }
+
+    if (Milliseconds == 0) {
+        Usage();
+        return 1;
+    }
+
+    //
+    // Init picks SSE2 the way the driver does; only offer it when it did.
+    //
+
+    {
+        ToneGenerator Generator;
+        WAVEFORMATEXTENSIBLE Format;
+
+        InitFormat(&Format, 16, 2);
+        if (!NT_SUCCESS(Generator.Init(TONE_FREQUENCY, &Format))) {
+            printf("Out of memory\n");
+            return 1;
+        }
+        Present[BenchRoutineSse2] = Generator.m_UseSse2;
+    }
+
+    QueryPerformanceFrequency(&g_Frequency);
+
+    //
+    // Keep the timing thread on one processor and ahead of the rest of
+    // the system.
+    //
+
+    SetThreadAffinityMask(GetCurrentThread(), 1);
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+
+    printf("%-7s %4s %8s %7s %12s %10s %8s\n",
+           "Routine", "Bits", "Channels", "Frames", "ns/call", "ns/frame", "vs sin");
+
+    for (b = 0; b < ARRAYSIZE(g_Bits); b++) {
+        for (c = 0; c < ARRAYSIZE(g_Channels); c++) {
+            for (f = 0; f < ARRAYSIZE(g_FrameCounts); f++) {
+
+                Baseline = 0.0;
+
+                for (r = 0; r < BenchRoutineCount; r++) {
+                    BENCH_ROUTINE Routine = (BENCH_ROUTINE)r;
+
+                    if (!Present[r]) {
+                        continue;
+                    }
+
+                    if (Routine != BenchRoutineSin) {
+                        Difference = CheckRoutine(Routine, g_Bits[b], g_Channels[c], g_FrameCounts[f]);
+                        if (Difference < 0) {
+                            printf("Out of memory\n");
+                            return 1;
+                        }
+
+                        if (Difference > CHECK_TOLERANCE) {
+                            printf("%-7s %4u %8u %7u    MISMATCH against the sin() loop (%d LSB)\n",
+                                   g_RoutineNames[r], g_Bits[b], g_Channels[c], g_FrameCounts[f], Difference);
+                            Failures++;
+                            continue;
+                        }
+                    }
+
+                    Time = TimeRoutine(Routine, g_Bits[b], g_Channels[c], g_FrameCounts[f], Milliseconds);
+                    if (Time < 0.0) {
+                        printf("Out of memory\n");
+                        return 1;
+                    }
+
+                    if (Routine == BenchRoutineSin) {
+                        Baseline = Time;
+                    }
+
+                    printf("%-7s %4u %8u %7u %12.1f %10.3f %7.2fx\n",
+                           g_RoutineNames[r], g_Bits[b], g_Channels[c], g_FrameCounts[f],
+                           Time, Time / g_FrameCounts[f], Baseline / Time);
+                }
+            }
+        }
+    }
+
+    if (Failures != 0) {
+        printf("\n%d routine checks failed\n", Failures);
+        return 2;
+    }
+
+    return 0;
+}
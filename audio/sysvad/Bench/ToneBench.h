@@ -0,0 +1,90 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    ToneBench.h
+
+Abstract:
+
+    The parts of the kernel, PortCls and SYSVAD headers that
+    ToneGenerator.cpp uses, for building it into the user mode benchmark.
+    User mode threads always have their floating point state saved, so
+    saving it is a no-op here.
+
+
+--*/
+#ifndef _SYSVAD_TONEBENCH_H
+#define _SYSVAD_TONEBENCH_H
+
+#define WIN32_NO_STATUS
+#include <windows.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+#include <mmreg.h>
+#include <ks.h>
+#include <ksmedia.h>
+
+typedef LONG NTSTATUS;
+
+#define NT_SUCCESS(Status) (((NTSTATUS)(Status)) >= 0)
+
+#define ASSERT(exp)
+
+//
+// Pool, floating point state and processor feature routines.
+//
+
+#define SYSVAD_POOLTAG 'DVSM'
+
+#define NonPagedPoolNx 0
+
+#define ExAllocatePoolWithTag(_Type, _Size, _Tag) HeapAlloc(GetProcessHeap(), 0, (_Size))
+#define ExFreePoolWithTag(_Pool, _Tag) HeapFree(GetProcessHeap(), 0, (_Pool))
+
+typedef struct _KFLOATING_SAVE {
+    ULONG Dummy;
+} KFLOATING_SAVE, *PKFLOATING_SAVE;
+
+#define KeSaveFloatingPointState(_Save) ((_Save)->Dummy = 0, STATUS_SUCCESS)
+#define KeRestoreFloatingPointState(_Save) ((void)(_Save))
+
+#define ExIsProcessorFeaturePresent(_Feature) IsProcessorFeaturePresent(_Feature)
+
+#define IsEqualGUIDAligned(_Guid1, _Guid2) IsEqualGUID((_Guid1), (_Guid2))
+
+//
+// Macros of common.h.
+//
+
+#define IF_TRUE_JUMP(condition, label)                          \
+    if (condition)                                              \
+    {                                                           \
+        goto label;                                             \
+    }
+
+#define IF_TRUE_ACTION_JUMP(condition, action, label)           \
+    if (condition)                                              \
+    {                                                           \
+        action;                                                 \
+        goto label;                                             \
+    }
+
+#define IF_FAILED_JUMP(ntStatus, label)                         \
+    if (!NT_SUCCESS(ntStatus))                                  \
+    {                                                           \
+        goto label;                                             \
+    }
+
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+
+//
+// Sample conversions of ToneGenerator.cpp, which the benchmark's per
+// frame sin() reference uses too.
+//
+
+short ConvertToShort(double Value);
+unsigned char ConvertToUChar(double Value);
+
+#endif // _SYSVAD_TONEBENCH_H
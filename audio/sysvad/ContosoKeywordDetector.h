@@ -25,10 +25,14 @@ typedef struct
 } CONTOSO_KEYWORDCONFIGURATION;
 
 //
-// The format of the Contoso match result data.
+// The format of the Contoso match result data. The keyword position is in
+// performance counter units; the keyword pin streams from half a second
+// before the start.
 //
 typedef struct
 {
     SOUNDDETECTOR_PATTERNHEADER Header;
     LONGLONG                    ContosoDetectorResultData;
+    ULONGLONG                   KeywordStartPerformanceCounter;
+    ULONGLONG                   KeywordEndPerformanceCounter;
 } CONTOSO_KEYWORDDETECTIONRESULT;
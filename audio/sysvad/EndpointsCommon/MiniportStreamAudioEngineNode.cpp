@@ -827,7 +827,7 @@ NTSTATUS CMiniportWaveRTStream::SetCurrentWritePositionInternal(_In_  ULONG _ulC
     //
     // Check for eMINIPORT_GLITCH_REPORT - 'same writert buffer' only when in event mode.
     //
-    if (m_ulNotificationIntervalMs > 0)
+    if (m_ullNotificationIntervalHns > 0)
     {
         if (m_ulCurrentWritePosition == _ulCurrentWritePosition)
         {
@@ -155,6 +155,9 @@ Return Value:
         m_pDrmPort = NULL;
     }
 
+    // The keyword detector signals through the port events
+    m_KeywordDetector.Shutdown();
+
     if (m_pPortEvents)
     {
         m_pPortEvents->Release();
@@ -520,6 +523,8 @@ Return Value:
         m_pPortEvents = NULL;
     }
 
+    m_KeywordDetector.SetPortEvents(m_pPortEvents);
+
     return ntStatus;
 } // Init
 
@@ -1814,17 +1819,10 @@ DEFINE_CLASSPROPERTYHANDLER(CMiniportWaveRT, Set_SoundDetectorArmed)
 
     armed = ((*(BOOL*)PropertyRequest->Value) != 0);
 
+    // The detector signals KSEVENT_SOUNDDETECTOR_MATCHDETECTED from its
+    // timer when it hears the keyword, and disarms itself.
     ntStatus = m_KeywordDetector.SetArmed(armed);
 
-    if (NT_SUCCESS(ntStatus) && armed)
-    {
-        // FUTURE-2014/10/20 For now immediately signal a detection as soon as
-        // it is armed, but later, find a better way to demonstrate this from
-        // within CKeywordDetector.
-        m_pPortEvents->GenerateEventList(const_cast<GUID*>(&KSEVENTSETID_SoundDetector), KSEVENT_SOUNDDETECTOR_MATCHDETECTED, FALSE, 0, FALSE, 0);
-        m_KeywordDetector.SetArmed(FALSE);
-    }
-
     return ntStatus;
 }
 
@@ -1846,6 +1844,7 @@ DEFINE_CLASSPROPERTYHANDLER(CMiniportWaveRT, Get_SoundDetectorMatchResult)
     value->Header.Size = sizeof(CONTOSO_KEYWORDDETECTIONRESULT);
     value->Header.PatternType = CONTOSO_KEYWORDCONFIGURATION_IDENTIFIER;
     value->ContosoDetectorResultData = m_KeywordDetector.GetDetectorData();
+    m_KeywordDetector.GetKeywordPosition(&value->KeywordStartPerformanceCounter, &value->KeywordEndPerformanceCounter);
 
     PropertyRequest->ValueSize = sizeof(*value);
     
@@ -1917,6 +1916,9 @@ Return Value:
             case KSPROPERTY_SYSVAD_DEFAULTSTREAMEFFECTS:
                 ntStatus = pWaveHelper->PropertyHandlerEffectListRequest(PropertyRequest);
                 break;
+            case KSPROPERTY_SYSVAD_SAVEDATA_STATISTICS:
+                ntStatus = CSaveData::PropertyHandlerStatistics(PropertyRequest);
+                break;
             default:
                 DPF(D_TERSE, ("[PropertyHandler_WaveFilter: Invalid Device Request]"));
         }
@@ -2062,22 +2064,77 @@ PropertyHandler_OffloadPin
 }
 
 
-// ISSUE-2014/10/20 Add synchronization mechanism throughout this class
 // ISSUE-2014/10/20 Add comment headers and commenting throughout
+//
+// Threading: the property handlers and the keyword pin call in at
+// PASSIVE_LEVEL; the timer callback produces packets at DISPATCH_LEVEL. The
+// timer callback is the only writer of the history ring and of the detector
+// state, and the reader owns its cursor, so the data path takes no lock.
+// Starting and stopping the timer is done from PASSIVE_LEVEL only.
+//
 #pragma code_seg("PAGE")
 CKeywordDetector::CKeywordDetector()
     :
+    m_SoundDetectorArmed(FALSE),
+    m_SoundDetectorData(0),
+    m_PinRunning(FALSE),
+    m_PortEvents(NULL),
+    m_pTimer(NULL),
     m_qpcStartCapture(0),
+    m_qpcFrequency(0),
     m_nLastQueuedPacket(-1),
-    m_SoundDetectorArmed(FALSE),
-    m_SoundDetectorData(0)
+    m_nNextReadPacket(0),
+    m_nHandoverPacket(-1),
+    m_NoiseFloor(0),
+    m_nVoiceStartPacket(0),
+    m_nVoicePackets(0),
+    m_Seed(1),
+    m_qpcKeywordStart(0),
+    m_qpcKeywordEnd(0),
+    m_ullProcessingTicks(0),
+    m_ullProcessedPackets(0)
+{
+    PAGED_CODE();
+
+    ResetFifo();
+}
+
+#pragma code_seg("PAGE")
+CKeywordDetector::~CKeywordDetector()
+{
+    PAGED_CODE();
+
+    Shutdown();
+}
+
+#pragma code_seg("PAGE")
+VOID CKeywordDetector::SetPortEvents(PPORTEVENTS PortEvents)
 {
     PAGED_CODE();
 
-    // Initialize our pool of packets and the list structures
-    KeInitializeSpinLock(&PacketPoolSpinLock);
-    KeInitializeSpinLock(&PacketFifoSpinLock);
+    m_PortEvents = PortEvents;
+}
+
+//
+// Stops the simulated DSP for good. Called before the port events go away.
+//
+#pragma code_seg("PAGE")
+VOID CKeywordDetector::Shutdown()
+{
+    PAGED_CODE();
+
+    if (m_pTimer != NULL)
+    {
+        // Cancel the timer and wait for a callback that is already running
+        // to return.
+        ExDeleteTimer(m_pTimer, TRUE, TRUE, NULL);
+        m_pTimer = NULL;
+    }
+
     ResetFifo();
+    m_SoundDetectorArmed = FALSE;
+    m_PinRunning = FALSE;
+    m_PortEvents = NULL;
 }
 
 #pragma code_seg("PAGE")
@@ -2104,6 +2161,18 @@ LONGLONG CKeywordDetector::GetDetectorData()
     return m_SoundDetectorData;
 }
 
+#pragma code_seg("PAGE")
+VOID CKeywordDetector::GetKeywordPosition(ULONGLONG *StartPerformanceCounter, ULONGLONG *EndPerformanceCounter)
+{
+    PAGED_CODE();
+
+    *StartPerformanceCounter = m_qpcKeywordStart;
+    *EndPerformanceCounter = m_qpcKeywordEnd;
+}
+
+//
+// Empties the history ring. The timer must not be running.
+//
 #pragma code_seg("PAGE")
 VOID CKeywordDetector::ResetFifo()
 {
@@ -2111,30 +2180,41 @@ VOID CKeywordDetector::ResetFifo()
 
     m_qpcStartCapture = 0;
     m_nLastQueuedPacket = (-1);
-    InitializeListHead(&PacketPoolHead);
-    InitializeListHead(&PacketFifoHead);
+    m_nNextReadPacket = 0;
+    m_nHandoverPacket = (-1);
 
-    for (int i = 0; i < ARRAYSIZE(PacketPool); i++)
-    {
-        InsertTailList(&PacketPoolHead, &PacketPool[i].ListEntry);
-    }
+    m_NoiseFloor = 0;
+    m_nVoicePackets = 0;
+    m_Seed = 1;
     return;
 }
 
 #pragma code_seg("PAGE")
 NTSTATUS CKeywordDetector::SetArmed(BOOL Arm)
 {
+    NTSTATUS ntStatus = STATUS_SUCCESS;
+
     PAGED_CODE();
 
-    BOOL previousArming = m_SoundDetectorArmed;
+    if (Arm && m_qpcStartCapture == 0)
+    {
+        ntStatus = StartBufferingStream();
+        if (!NT_SUCCESS(ntStatus))
+        {
+            return ntStatus;
+        }
+    }
 
     m_SoundDetectorArmed = Arm;
 
-    if (Arm && !previousArming && m_qpcStartCapture == 0)
+    // Nobody needs the audio once the detector is disarmed and the keyword
+    // pin is not streaming.
+    if (!Arm && !m_PinRunning)
     {
-        StartBufferingStream();
+        StopBufferingStream();
     }
-    return STATUS_SUCCESS;
+
+    return ntStatus;
 }
 
 #pragma code_seg("PAGE")
@@ -2150,9 +2230,14 @@ VOID CKeywordDetector::Run()
 {
     PAGED_CODE();
 
+    m_PinRunning = TRUE;
+
     if (m_qpcStartCapture == 0)
     {
-        StartBufferingStream();
+        if (!NT_SUCCESS(StartBufferingStream()))
+        {
+            DPF(D_ERROR, ("[CKeywordDetector::Run] failed to start the detector timer"));
+        }
     }
 }
 
@@ -2161,80 +2246,273 @@ VOID CKeywordDetector::Stop()
 {
     PAGED_CODE();
 
-    ResetFifo();
+    m_PinRunning = FALSE;
+
+    // An armed detector keeps listening
+    if (!m_SoundDetectorArmed)
+    {
+        StopBufferingStream();
+    }
 }
 
 #pragma code_seg("PAGE")
-VOID CKeywordDetector::StartBufferingStream()
+NTSTATUS CKeywordDetector::StartBufferingStream()
 {
     LARGE_INTEGER qpc;
     LARGE_INTEGER qpcFrequency;
+    EXT_SET_PARAMETERS parameters;
+    const LONGLONG period = HNSTIME_PER_SECOND / PacketsPerSecond;
 
     PAGED_CODE();
 
     NT_ASSERT(m_qpcStartCapture == 0);
-    NT_ASSERT(IsListEmpty(&PacketFifoHead));
+    NT_ASSERT(m_nLastQueuedPacket == (-1));
+
+    if (m_pTimer == NULL)
+    {
+        m_pTimer = ExAllocateTimer(KeywordDetectorTimerNotify, this, EX_TIMER_HIGH_RESOLUTION);
+        if (m_pTimer == NULL)
+        {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+
+    m_ullProcessingTicks = 0;
+    m_ullProcessedPackets = 0;
 
     qpc = KeQueryPerformanceCounter(&qpcFrequency);
+    m_qpcFrequency = qpcFrequency.QuadPart;
     m_qpcStartCapture = qpc.QuadPart;
 
-    return;
+    ExInitializeSetTimerParameters(&parameters);
+    ExSetTimer(m_pTimer, -period, period, &parameters);
+
+    return STATUS_SUCCESS;
+}
+
+#pragma code_seg("PAGE")
+VOID CKeywordDetector::StopBufferingStream()
+{
+    PAGED_CODE();
+
+    if (m_qpcStartCapture == 0)
+    {
+        return;
+    }
+
+    ExCancelTimer(m_pTimer, NULL);
+    KeFlushQueuedDpcs();
+
+    // Report what the simulated DSP cost, as a share of one processor
+    if (m_ullProcessedPackets > 0 && m_qpcFrequency > 0)
+    {
+        ULONGLONG cpuUs   = m_ullProcessingTicks * 1000000 / m_qpcFrequency;
+        ULONGLONG audioUs = m_ullProcessedPackets * (1000000 / PacketsPerSecond);
+
+        DPF(D_TERSE, ("[CKeywordDetector::StopBufferingStream] %I64u us CPU for %I64u ms of audio, %I64u.%02I64u%% of a core",
+            cpuUs,
+            audioUs / 1000,
+            cpuUs * 100 / audioUs,
+            (cpuUs * 10000 / audioUs) % 100));
+    }
+
+    ResetFifo();
+}
+
+//
+// Simulated microphone: low level noise, with 600ms of a 500Hz triangle
+// wave standing in for the keyword every 3 seconds.
+//
+#pragma code_seg()
+VOID CKeywordDetector::SynthesizePacket(LONGLONG PacketNumber, LONGLONG QpcWhenSampled, INT16 *Samples)
+{
+    const LONGLONG cyclePackets = 3 * PacketsPerSecond;
+    const LONGLONG voiceFirstPacket = PacketsPerSecond;
+    const LONGLONG voicePackets = 60;
+    const ULONG halfPeriod = SamplesPerSecond / 500 / 2;
+    const INT32 slope = 1000;
+    LONGLONG cyclePacket = PacketNumber % cyclePackets;
+    BOOL voice = (cyclePacket >= voiceFirstPacket && cyclePacket < voiceFirstPacket + voicePackets);
+    LONGLONG signature[2];
+
+    for (int i = 0; i < SamplesPerPacket; i++)
+    {
+        INT32 sample;
+
+        m_Seed = m_Seed * 1664525 + 1013904223;
+        sample = (INT32)(m_Seed >> 25) - 64;
+
+        if (voice)
+        {
+            ULONG phase = (ULONG)((PacketNumber * SamplesPerPacket + i) % (2 * halfPeriod));
+
+            sample += (phase < halfPeriod) ?
+                ((INT32)phase * slope - (INT32)halfPeriod * slope / 2) :
+                ((INT32)(2 * halfPeriod - phase) * slope - (INT32)halfPeriod * slope / 2);
+        }
+
+        Samples[i] = (INT16)sample;
+    }
+
+    // For test purposes, embed the packet number and sample time into the audio data
+    signature[0] = PacketNumber;
+    signature[1] = QpcWhenSampled;
+    RtlCopyMemory(Samples, signature, sizeof(signature));
+}
+
+//
+// The detector. Each packet is reduced to two features, its energy and its
+// zero crossing count, and those are compared against a running noise
+// floor. A keyword is a run of voiced packets of the right length; it
+// matches on the first unvoiced packet after it. Integer arithmetic only,
+// so no floating point state has to be saved at DISPATCH_LEVEL.
+//
+#pragma code_seg()
+BOOL CKeywordDetector::DetectPacket(LONGLONG PacketNumber, const INT16 *Samples)
+{
+    const ULONG maxVoiceCrossings = 40;
+    const ULONG minVoiceEnergy = 1000;
+    ULONG energy = 0;
+    ULONG crossings = 0;
+    BOOL voiced;
+    BOOL match;
+
+    for (int i = SignatureSamples; i < SamplesPerPacket; i++)
+    {
+        INT32 sample = Samples[i];
+
+        energy += (ULONG)(sample * sample) >> 6;
+
+        if (i > SignatureSamples && ((sample < 0) != (Samples[i - 1] < 0)))
+        {
+            crossings++;
+        }
+    }
+
+    voiced = (crossings <= maxVoiceCrossings) && (energy > m_NoiseFloor * 8 + minVoiceEnergy);
+
+    if (voiced)
+    {
+        if (m_nVoicePackets == 0)
+        {
+            m_nVoiceStartPacket = PacketNumber;
+        }
+
+        // Stop counting once the run is too long to be a keyword
+        if (m_nVoicePackets <= MaxKeywordPackets)
+        {
+            m_nVoicePackets++;
+        }
+        return FALSE;
+    }
+
+    m_NoiseFloor = m_NoiseFloor - m_NoiseFloor / 16 + energy / 16;
+
+    match = (m_nVoicePackets >= MinKeywordPackets && m_nVoicePackets <= MaxKeywordPackets);
+    if (match)
+    {
+        m_qpcKeywordStart = m_qpcStartCapture + m_nVoiceStartPacket * m_qpcFrequency / PacketsPerSecond;
+        m_qpcKeywordEnd = m_qpcStartCapture + PacketNumber * m_qpcFrequency / PacketsPerSecond;
+
+        // Hand the pre-roll and the keyword to the keyword pin
+        WriteRelease64(&m_nHandoverPacket, max(m_nVoiceStartPacket - PrerollPackets, 0));
+    }
+
+    m_nVoicePackets = 0;
+    return match;
 }
 
 #pragma code_seg()
 VOID CKeywordDetector::DpcRoutine(LONGLONG PerformanceCounter, LONGLONG PerformanceFrequency)
 {
     LONGLONG currentPacket;
-    LONGLONG packetsToQueue;
+    LONGLONG packetNumber;
+    LARGE_INTEGER qpcStart;
+    LARGE_INTEGER qpcEnd;
 
     if (m_qpcStartCapture <= 0)
     {
         return;
     }
 
-    currentPacket = (PerformanceCounter - m_qpcStartCapture) * (SamplesPerSecond / SamplesPerPacket) / PerformanceFrequency;
-    packetsToQueue = currentPacket - m_nLastQueuedPacket;
+    qpcStart = KeQueryPerformanceCounter(NULL);
 
-    while (packetsToQueue > 0)
+    currentPacket = (PerformanceCounter - m_qpcStartCapture) * PacketsPerSecond / PerformanceFrequency;
+    packetNumber = m_nLastQueuedPacket;
+
+    // After a stall, only produce the packets the ring can hold
+    if (currentPacket - packetNumber > HistoryPackets)
     {
-        LIST_ENTRY*     packetListEntry;
-        PACKET_ENTRY*   packetEntry;
-        LONGLONG*       signature;
+        packetNumber = currentPacket - HistoryPackets;
+    }
 
-        do
-        {
-            packetListEntry = ExInterlockedRemoveHeadList(&PacketPoolHead, &PacketPoolSpinLock);
-            if (packetListEntry != NULL) break;
+    while (packetNumber < currentPacket)
+    {
+        INT16 *samples;
+
+        packetNumber++;
+        samples = m_History[packetNumber % HistoryPackets];
 
-            // Pool is empty, no room to buffer more, an overrun is occurring. Drop and reuse the
-            // oldest packet from head of fifo.
+        SynthesizePacket(packetNumber, m_qpcStartCapture + (packetNumber * PerformanceFrequency / PacketsPerSecond), samples);
 
-            // Since the pool is empty, the fifo should be full. However, although unlikely, the
-            // driver might empty the fifo before this routine removes a packet. In that case, the
-            // pool should have packets available again. Therefore this is a retry loop.
-            packetListEntry = ExInterlockedRemoveHeadList(&PacketFifoHead, &PacketFifoSpinLock);
-            if (packetListEntry != NULL) break;
-        } while (TRUE);
+        WriteRelease64(&m_nLastQueuedPacket, packetNumber);
 
-        packetEntry = CONTAINING_RECORD(packetListEntry, PACKET_ENTRY, ListEntry);
+        if (m_SoundDetectorArmed)
+        {
+            if (DetectPacket(packetNumber, samples))
+            {
+                // Like the hardware, the detector disarms itself on a match
+                m_SoundDetectorArmed = FALSE;
 
-        packetEntry->PacketNumber = ++m_nLastQueuedPacket;
-        packetEntry->QpcWhenSampled = m_qpcStartCapture + (packetEntry->PacketNumber * PerformanceFrequency * SamplesPerPacket / SamplesPerSecond);
+                if (m_PortEvents != NULL)
+                {
+                    m_PortEvents->GenerateEventList(const_cast<GUID*>(&KSEVENTSETID_SoundDetector), KSEVENT_SOUNDDETECTOR_MATCHDETECTED, FALSE, 0, FALSE, 0);
+                }
+            }
+        }
+        else
+        {
+            m_nVoicePackets = 0;
+        }
 
-        RtlZeroMemory(&packetEntry->Samples[0], sizeof(packetEntry->Samples));
+        m_ullProcessedPackets++;
+    }
 
-        // For test purposes, embed the packet number and sample time into the audio data
-        signature = (LONGLONG*)(&packetEntry->Samples[0]);
+    qpcEnd = KeQueryPerformanceCounter(NULL);
+    m_ullProcessingTicks += qpcEnd.QuadPart - qpcStart.QuadPart;
+}
 
-        signature[0] = packetEntry->PacketNumber;
-        signature[1] = packetEntry->QpcWhenSampled;
+#pragma code_seg()
+void
+KeywordDetectorTimerNotify
+(
+    _In_      PEX_TIMER     Timer,
+    _In_opt_  PVOID         Context
+)
+{
+    LARGE_INTEGER qpc;
+    LARGE_INTEGER qpcFrequency;
+    CKeywordDetector* _this = (CKeywordDetector*)Context;
+
+    UNREFERENCED_PARAMETER(Timer);
 
-        ExInterlockedInsertTailList(&PacketFifoHead, packetListEntry, &PacketFifoSpinLock);
+    _IRQL_limited_to_(DISPATCH_LEVEL);
 
-        packetsToQueue -= 1;
+    if (NULL == _this)
+    {
+        return;
     }
+
+    qpc = KeQueryPerformanceCounter(&qpcFrequency);
+
+    _this->DpcRoutine(qpc.QuadPart, qpcFrequency.QuadPart);
 }
 
+//
+// Copies the next packet from the history ring into the WaveRT buffer. The
+// ring is the only copy of the audio until then; the packet lands at the
+// offset of its number, as the OS expects.
+//
 #pragma code_seg()
 _IRQL_requires_max_(PASSIVE_LEVEL)
 NTSTATUS CKeywordDetector::GetReadPacket
@@ -2249,39 +2527,60 @@ NTSTATUS CKeywordDetector::GetReadPacket
 {
     NTSTATUS ntStatus;
     BYTE *packetData;
-    PACKET_ENTRY *packetEntry;
-    LIST_ENTRY *packetListEntry = NULL;
+    LONGLONG handoverPacket;
+    LONGLONG lastPacket;
+    LONGLONG packetNumber;
     ULONG packetSize = WaveRtBufferSize / PacketsPerWaveRtBuffer;
 
     NT_ASSERT(SamplesPerPacket * 2 == packetSize);
-    NT_ASSERT(sizeof(packetEntry->Samples) == packetSize);
+    NT_ASSERT(sizeof(m_History[0]) == packetSize);
 
-    packetListEntry = ExInterlockedRemoveHeadList(&PacketFifoHead, &PacketFifoSpinLock);
-    if (packetListEntry == NULL)
+    // After a match, start with the pre-roll
+    handoverPacket = InterlockedExchange64(&m_nHandoverPacket, -1);
+    if (handoverPacket > m_nNextReadPacket)
     {
-        ntStatus = STATUS_DEVICE_NOT_READY;
-        goto Exit;
+        m_nNextReadPacket = handoverPacket;
     }
-    packetEntry = CONTAINING_RECORD(packetListEntry, PACKET_ENTRY, ListEntry);
-
-    packetData = WaveRtBuffer + ((packetEntry->PacketNumber * packetSize) % WaveRtBufferSize);
 
-    ntStatus = RtlLongLongToULong(packetEntry->PacketNumber, PacketNumber);
-    if (!NT_SUCCESS(ntStatus))
+    for (;;)
     {
-        goto Exit;
-    }
+        lastPacket = ReadAcquire64(&m_nLastQueuedPacket);
+        if (m_nNextReadPacket > lastPacket)
+        {
+            return STATUS_DEVICE_NOT_READY;
+        }
+
+        // The timer may be writing over the packet after the oldest one at
+        // any time. Older packets are an overrun and are dropped.
+        if (m_nNextReadPacket < lastPacket - (HistoryPackets - 2))
+        {
+            m_nNextReadPacket = lastPacket - (HistoryPackets - 2);
+        }
+
+        packetNumber = m_nNextReadPacket;
+        packetData = WaveRtBuffer + ((packetNumber * packetSize) % WaveRtBufferSize);
 
-    *PerformanceCounterValue = packetEntry->QpcWhenSampled;
-    *MoreData = !IsListEmpty(&PacketFifoHead);
-    RtlCopyMemory(packetData, packetEntry->Samples, sizeof(packetEntry->Samples));
+        RtlCopyMemory(packetData, m_History[packetNumber % HistoryPackets], packetSize);
 
-Exit:
-    if (packetListEntry != NULL)
+        // If the timer didn't lap the copy, the packet is good
+        KeMemoryBarrier();
+        lastPacket = ReadAcquire64(&m_nLastQueuedPacket);
+        if (packetNumber >= lastPacket - (HistoryPackets - 2))
+        {
+            break;
+        }
+    }
+
+    ntStatus = RtlLongLongToULong(packetNumber, PacketNumber);
+    if (!NT_SUCCESS(ntStatus))
     {
-        ExInterlockedInsertTailList(&PacketPoolHead, packetListEntry, &PacketPoolSpinLock);
+        return ntStatus;
     }
 
-    return ntStatus;
+    *PerformanceCounterValue = m_qpcStartCapture + (packetNumber * m_qpcFrequency / PacketsPerSecond);
+    *MoreData = (packetNumber < lastPacket);
+    m_nNextReadPacket = packetNumber + 1;
+
+    return STATUS_SUCCESS;
 }
 
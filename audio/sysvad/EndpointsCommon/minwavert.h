@@ -31,10 +31,26 @@ typedef CMiniportWaveRTStream *PCMiniportWaveRTStream;
 ///////////////////////////////////////////////////////////////////////////////
 // CKeywordDetector
 //
+// Simulates a hardware keyword detector. A periodic timer stands in for the
+// detector's DSP: every 10ms it writes one packet of synthesized microphone
+// audio into a history ring and, while armed, runs the packet through the
+// detector. The keyword pin reads straight out of the same ring with its
+// own cursor, so on a match the pre-roll and the keyword are already there
+// to hand over.
+//
+EXT_CALLBACK KeywordDetectorTimerNotify;
+
 class CKeywordDetector
 {
 public:
     CKeywordDetector();
+    ~CKeywordDetector();
+
+    _IRQL_requires_max_(PASSIVE_LEVEL)
+    VOID SetPortEvents(_In_opt_ PPORTEVENTS PortEvents);
+
+    _IRQL_requires_max_(PASSIVE_LEVEL)
+    VOID Shutdown();
 
     _IRQL_requires_max_(PASSIVE_LEVEL)
     VOID ResetDetector();
@@ -45,6 +61,9 @@ public:
     _IRQL_requires_max_(PASSIVE_LEVEL)
     LONGLONG GetDetectorData();
 
+    _IRQL_requires_max_(PASSIVE_LEVEL)
+    VOID GetKeywordPosition(_Out_ ULONGLONG *StartPerformanceCounter, _Out_ ULONGLONG *EndPerformanceCounter);
+
     _IRQL_requires_max_(PASSIVE_LEVEL)
     NTSTATUS SetArmed(_In_ BOOL Arm);
 
@@ -57,45 +76,84 @@ public:
     _IRQL_requires_max_(PASSIVE_LEVEL)
     VOID Stop();
 
-    _IRQL_requires_min_(DISPATCH_LEVEL)
-    VOID DpcRoutine(_In_ LONGLONG PeformanceCounter, _In_ LONGLONG PerformanceFrequency);
-
     _IRQL_requires_max_(PASSIVE_LEVEL)
     NTSTATUS GetReadPacket(_In_ ULONG PacketsPerWaveRtBuffer, _In_  ULONG WaveRtBufferSize, _Out_writes_(WaveRtBufferSize) BYTE *WaveRtBuffer, _Out_ ULONG *PacketNumber, _Out_ ULONGLONG *PerformanceCount, _Out_ BOOL *MoreData);
 
 private:
+    friend EXT_CALLBACK KeywordDetectorTimerNotify;
+
     _IRQL_requires_max_(PASSIVE_LEVEL)
     VOID ResetFifo();
 
     _IRQL_requires_max_(PASSIVE_LEVEL)
-    VOID StartBufferingStream();
+    NTSTATUS StartBufferingStream();
+
+    _IRQL_requires_max_(PASSIVE_LEVEL)
+    VOID StopBufferingStream();
+
+    _IRQL_requires_min_(DISPATCH_LEVEL)
+    VOID DpcRoutine(_In_ LONGLONG PeformanceCounter, _In_ LONGLONG PerformanceFrequency);
+
+    _IRQL_requires_min_(DISPATCH_LEVEL)
+    VOID SynthesizePacket(_In_ LONGLONG PacketNumber, _In_ LONGLONG QpcWhenSampled, _Out_writes_(SamplesPerPacket) INT16 *Samples);
+
+    _IRQL_requires_min_(DISPATCH_LEVEL)
+    BOOL DetectPacket(_In_ LONGLONG PacketNumber, _In_reads_(SamplesPerPacket) const INT16 *Samples);
 
     // The Contoso keyword detector processes 10ms packets of 16KHz 16-bit PCM
     // audio samples
     static const int SamplesPerSecond = 16000;
     static const int SamplesPerPacket = (10 * SamplesPerSecond / 1000);
+    static const int PacketsPerSecond = (SamplesPerSecond / SamplesPerPacket);
 
-    typedef struct
-    {
-        LIST_ENTRY  ListEntry;
-        LONGLONG    PacketNumber;
-        LONGLONG    QpcWhenSampled;
-        UINT16      Samples[SamplesPerPacket];
-    } PACKET_ENTRY;
+    // The first samples of each packet carry its number and sample time, for
+    // test purposes. The detector skips them.
+    static const int SignatureSamples = (2 * sizeof(LONGLONG) / sizeof(INT16));
+
+    // Enough history for the pre-roll, the longest keyword and a second of
+    // reading latency
+    static const int HistoryPackets = 3 * PacketsPerSecond;
+    static const int PrerollPackets = PacketsPerSecond / 2;
+
+    // A keyword is 300ms to 1.5s of voice followed by a packet of silence
+    static const int MinKeywordPackets = 30;
+    static const int MaxKeywordPackets = 150;
 
     BOOL            m_SoundDetectorArmed;
     LONGLONG        m_SoundDetectorData;
+    BOOL            m_PinRunning;
+    PPORTEVENTS     m_PortEvents;               // weak ref
 
+    PEX_TIMER       m_pTimer;
     LONGLONG        m_qpcStartCapture;
-    LONGLONG        m_nLastQueuedPacket;
+    LONGLONG        m_qpcFrequency;
 
-    KSPIN_LOCK      PacketPoolSpinLock;
-    LIST_ENTRY      PacketPoolHead;
-    PACKET_ENTRY    PacketPool[1 * SamplesPerSecond / SamplesPerPacket];    // Enough storage for 1 second of audio data
+    // Written only by the timer callback. The packets up to and including
+    // m_nLastQueuedPacket are in the ring, the oldest HistoryPackets - 1 of
+    // them intact.
+    volatile LONG64 m_nLastQueuedPacket;
 
-    KSPIN_LOCK      PacketFifoSpinLock;
-    LIST_ENTRY      PacketFifoHead;
+    // Owned by the keyword pin's reader
+    LONGLONG        m_nNextReadPacket;
 
+    // Set by the detector on a match: the packet the reader moves up to
+    volatile LONG64 m_nHandoverPacket;
+
+    // Detector state, touched only by the timer callback while armed
+    ULONG           m_NoiseFloor;
+    LONGLONG        m_nVoiceStartPacket;
+    LONG            m_nVoicePackets;
+    ULONG           m_Seed;
+
+    // Position of the last keyword, for the match result
+    ULONGLONG       m_qpcKeywordStart;
+    ULONGLONG       m_qpcKeywordEnd;
+
+    // Cost of the simulated DSP
+    ULONGLONG       m_ullProcessingTicks;
+    ULONGLONG       m_ullProcessedPackets;
+
+    INT16           m_History[HistoryPackets][SamplesPerPacket];
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -295,11 +353,6 @@ public:
     );   
 
 public:
-    VOID DpcRoutine(LONGLONG PeformanceCounter, LONGLONG PerformanceFrequency)
-    {
-        m_KeywordDetector.DpcRoutine(PeformanceCounter, PerformanceFrequency);
-    }
-
     NTSTATUS PropertyHandlerEffectListRequest
     (
         _In_ PPCPROPERTY_REQUEST PropertyRequest
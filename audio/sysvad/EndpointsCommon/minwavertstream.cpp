@@ -83,24 +83,35 @@ Return Value:
     }
     if (m_pNotificationTimer)
     {
-        KeCancelTimer(m_pNotificationTimer);
-        ExFreePoolWithTag(m_pNotificationTimer, MINWAVERTSTREAM_POOLTAG);
-    }
-
-    // Since we just cancelled the notification timer, wait for all queued 
-    // DPCs to complete before we free the notification DPC.
-    //
-    KeFlushQueuedDpcs();
-
-    if (m_pNotificationDpc)
-    {
-        ExFreePoolWithTag( m_pNotificationDpc, MINWAVERTSTREAM_POOLTAG );
+        // Cancel the notification timer and wait for a callback that is
+        // already running to return before the stream goes away.
+        ExDeleteTimer(m_pNotificationTimer, TRUE, TRUE, NULL);
+        m_pNotificationTimer = NULL;
     }
     
 #ifdef SYSVAD_BTH_BYPASS
     ASSERT(m_ScoOpen == FALSE);
 #endif  // SYSVAD_BTH_BYPASS
 
+    //
+    // Report the CPU time the data path took, normalized to a minute of audio,
+    // to compare the cost of many concurrent streams.
+    //
+    if (m_ullProcessedBytes != 0 && m_ulDmaMovementRate != 0 && m_ullPerformanceCounterFrequency.QuadPart != 0)
+    {
+        ULONGLONG cpuUs    = m_ullProcessingTicks * 1000000 / m_ullPerformanceCounterFrequency.QuadPart;
+        ULONGLONG streamMs = m_ullProcessedBytes * 1000 / m_ulDmaMovementRate;
+
+        if (streamMs != 0)
+        {
+            DPF(D_TERSE, ("[CMiniportWaveRTStream::~CMiniportWaveRTStream] %s: %I64u us CPU for %I64u ms of audio, %I64u us per stream-minute",
+                m_bCapture ? "capture" : "render",
+                cpuUs,
+                streamMs,
+                cpuUs * 60000 / streamMs));
+        }
+    }
+
     DPF_ENTER(("[CMiniportWaveRTStream::~CMiniportWaveRTStream]"));
 } // ~CMiniportWaveRTStream
 
@@ -161,8 +172,10 @@ Return Value:
     m_ullPlayPosition = 0;
     m_ullWritePosition = 0;
     m_ullDmaTimeStamp = 0;
-    m_hnsElapsedTimeCarryForward = 0;
+    m_ullDmaMovementCarryForward = 0;
     m_ulDmaMovementRate = 0;
+    m_ullProcessingTicks = 0;
+    m_ullProcessedBytes = 0;
     m_bLfxEnabled = FALSE;
     m_pbMuted = NULL;
     m_plVolumeLevel = NULL;
@@ -183,29 +196,21 @@ Return Value:
 
     m_pPortStream = PortStream_;
     InitializeListHead(&m_NotificationList);
-    m_ulNotificationIntervalMs = 0;
-
-    m_pNotificationDpc = (PRKDPC)ExAllocatePoolWithTag(
-        NonPagedPoolNx,
-        sizeof(KDPC),
-        MINWAVERTSTREAM_POOLTAG);
-    if (!m_pNotificationDpc)
-    {
-        return STATUS_INSUFFICIENT_RESOURCES;
-    }
+    m_ullNotificationIntervalHns = 0;
+    m_ullRunStartTime = 0;
+    m_llRunStartPacketCounter = 0;
 
-    m_pNotificationTimer = (PKTIMER)ExAllocatePoolWithTag(
-        NonPagedPoolNx,
-        sizeof(KTIMER),
-        MINWAVERTSTREAM_POOLTAG);
+    //
+    // Packets are timed with a high resolution timer: its period is set in
+    // 100ns units, so packets that are not a whole number of milliseconds
+    // long don't drift, and it doesn't depend on the system timer resolution.
+    //
+    m_pNotificationTimer = ExAllocateTimer(TimerNotifyRT, this, EX_TIMER_HIGH_RESOLUTION);
     if (!m_pNotificationTimer)
     {
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
-    KeInitializeDpc(m_pNotificationDpc, TimerNotifyRT, this);
-    KeInitializeTimerEx(m_pNotificationTimer, NotificationTimer);
-
     pWfEx = GetWaveFormatEx(DataFormat_);
     if (NULL == pWfEx) 
     { 
@@ -408,7 +413,6 @@ NTSTATUS CMiniportWaveRTStream::AllocateBufferWithNotification
 {
     PAGED_CODE();
 
-    ULONG ulBufferDurationMs = 0;
 
     if ( (0 == RequestedSize_) || (RequestedSize_ < m_pWfExt->Format.nBlockAlign) )
     { 
@@ -462,8 +466,8 @@ NTSTATUS CMiniportWaveRTStream::AllocateBufferWithNotification
     m_pDmaBuffer = (BYTE*)m_pPortStream->MapAllocatedPages(pBufferMdl, MmCached);
     m_ulNotificationsPerBuffer = NotificationCount_;
     m_ulDmaBufferSize = RequestedSize_;
-    ulBufferDurationMs = (RequestedSize_ * 1000) / m_ulDmaMovementRate;
-    m_ulNotificationIntervalMs = ulBufferDurationMs / NotificationCount_;
+    m_ullNotificationIntervalHns = ((ULONGLONG)RequestedSize_ * HNSTIME_PER_SECOND) /
+                                   ((ULONGLONG)m_ulDmaMovementRate * NotificationCount_);
 
     *AudioBufferMdl_ = pBufferMdl;
     *ActualSize_ = RequestedSize_;
@@ -1060,10 +1064,10 @@ NTSTATUS CMiniportWaveRTStream::SetState
             m_ulLastOsWritePacket = ULONG_MAX;
             m_llEoSPosition = (-1);
             
-            // Wait until all work items are completed.
+            // Save the data still buffered.
             if (!m_bCapture && !g_DoNotCreateDataFiles)
             {
-                m_SaveData.WaitAllWorkItems();
+                m_SaveData.Flush();
             }
 
 #ifdef SYSVAD_BTH_BYPASS
@@ -1129,10 +1133,9 @@ NTSTATUS CMiniportWaveRTStream::SetState
                 }
 
                 // Pause DMA
-                if (m_ulNotificationIntervalMs > 0)
+                if (m_ullNotificationIntervalHns > 0)
                 {
-                    KeCancelTimer(m_pNotificationTimer);
-                    ExSetTimerResolution(0, FALSE);
+                    ExCancelTimer(m_pNotificationTimer, NULL);
                     KeFlushQueuedDpcs(); 
                 }
             }
@@ -1150,23 +1153,24 @@ NTSTATUS CMiniportWaveRTStream::SetState
             }
             ullPerfCounterTemp = KeQueryPerformanceCounter(&m_ullPerformanceCounterFrequency);
             m_ullDmaTimeStamp = KSCONVERT_PERFORMANCE_TIME(m_ullPerformanceCounterFrequency.QuadPart, ullPerfCounterTemp);
-            m_hnsElapsedTimeCarryForward  = 0;
+            m_ullDmaMovementCarryForward  = 0;
 
-            if (m_ulNotificationIntervalMs > 0)
+            if (m_ullNotificationIntervalHns > 0)
             {
-                LARGE_INTEGER   delay;
+                EXT_SET_PARAMETERS  parameters;
+                LONGLONG            period = (LONGLONG)m_ullNotificationIntervalHns;
 
-                delay.QuadPart = (-2) * (((LONGLONG)m_ulNotificationIntervalMs) * HNSTIME_PER_MILLISECOND);
+                m_ullRunStartTime = m_ullDmaTimeStamp;
+                m_llRunStartPacketCounter = m_llPacketCounter;
 
-                // ISSUE-2014/10/20 Set resolution based on packet size
-                ExSetTimerResolution(HNSTIME_PER_MILLISECOND, TRUE);
+                ExInitializeSetTimerParameters(&parameters);
 
-                KeSetTimerEx
+                ExSetTimer
                 (
                     m_pNotificationTimer,
-                    delay,
-                    m_ulNotificationIntervalMs,
-                    m_pNotificationDpc
+                    (-2) * period,
+                    period,
+                    &parameters
                 );
             }
 
@@ -1212,33 +1216,35 @@ VOID CMiniportWaveRTStream::UpdatePosition
     // Convert ticks to 100ns units.
     LONGLONG  hnsCurrentTime = KSCONVERT_PERFORMANCE_TIME(m_ullPerformanceCounterFrequency.QuadPart, ilQPC);
     
-    // Calculate the time elapsed since the last call to GetPosition() or since the
-    // DMA engine started.  Note that the division by 10000 to convert to milliseconds
-    // may cause us to lose some of the time, so we will carry the remainder forward 
-    // to the next GetPosition() call.
-    //
-    ULONG TimeElapsedInMS = (ULONG)(hnsCurrentTime - m_ullDmaTimeStamp + m_hnsElapsedTimeCarryForward)/10000;
-    
-    // Carry forward the remainder of this division so we don't fall behind with our position too much.
+    // Calculate how many bytes in the DMA buffer would have been processed in the
+    // time elapsed since the last call to GetPosition() or since the DMA engine
+    // started. The position advances with 100ns precision rather than in whole
+    // milliseconds, which matters with packets of a few milliseconds. The
+    // fraction of a byte left over is carried forward to the next call so we
+    // don't fall behind with our position.
     //
-    m_hnsElapsedTimeCarryForward = (hnsCurrentTime - m_ullDmaTimeStamp + m_hnsElapsedTimeCarryForward) % 10000;
+    // need to divide by HNSTIME_PER_SECOND because m_ulDmaMovementRate is average bytes per sec.
+    ULONGLONG DmaMovement = (ULONGLONG)(hnsCurrentTime - m_ullDmaTimeStamp) * m_ulDmaMovementRate + m_ullDmaMovementCarryForward;
+    ULONG ByteDisplacement = (ULONG)(DmaMovement / HNSTIME_PER_SECOND);
     
-    // Calculate how many bytes in the DMA buffer would have been processed in the elapsed
-    // time.  Note that the division by 1000 to convert to milliseconds may cause us to 
-    // lose some bytes, so we will carry the remainder forward to the next GetPosition() call.
-    //
-    // need to divide by 1000 because m_ulDmaMovementRate is average bytes per sec.
-    ULONG ByteDisplacement = (m_ulDmaMovementRate * TimeElapsedInMS) / 1000;
+    m_ullDmaMovementCarryForward = DmaMovement % HNSTIME_PER_SECOND;
+    LARGE_INTEGER ilProcessingStart = KeQueryPerformanceCounter(NULL);
     
     if (m_bCapture)
     {
         // Write sine wave to buffer.
         WriteBytes(ByteDisplacement);
+
+        m_ullProcessingTicks += KeQueryPerformanceCounter(NULL).QuadPart - ilProcessingStart.QuadPart;
+        m_ullProcessedBytes += ByteDisplacement;
     }
     else if (!g_DoNotCreateDataFiles)
     {
         // Read from buffer and write to a file.
         ReadBytes(ByteDisplacement);
+
+        m_ullProcessingTicks += KeQueryPerformanceCounter(NULL).QuadPart - ilProcessingStart.QuadPart;
+        m_ullProcessedBytes += ByteDisplacement;
         
         // If the last packet was rendered(read in the sample driver's case), send out an etw event.
         if ( (m_llEoSPosition >= 0) 
@@ -1466,31 +1472,43 @@ Return Value:
 void
 TimerNotifyRT
 (
-    _In_      PKDPC         Dpc,
-    _In_opt_  PVOID         DeferredContext,
-    _In_opt_  PVOID         SA1,
-    _In_opt_  PVOID         SA2
+    _In_      PEX_TIMER     Timer,
+    _In_opt_  PVOID         Context
 )
 {
     LARGE_INTEGER qpc;
     LARGE_INTEGER qpcFrequency;
+    LONGLONG      elapsedHns;
+    LONGLONG      expectedPacketCounter;
 
-    UNREFERENCED_PARAMETER(Dpc);
-    UNREFERENCED_PARAMETER(SA1);
-    UNREFERENCED_PARAMETER(SA2);
+    UNREFERENCED_PARAMETER(Timer);
 
     _IRQL_limited_to_(DISPATCH_LEVEL);
 
     qpc = KeQueryPerformanceCounter(&qpcFrequency);
 
-    CMiniportWaveRTStream* _this = (CMiniportWaveRTStream*)DeferredContext;
+    CMiniportWaveRTStream* _this = (CMiniportWaveRTStream*)Context;
     
     if (NULL == _this)
     {
         return;
     }
 
-    InterlockedIncrement64(&_this->m_llPacketCounter);
+    // The first packet completes two periods after the stream starts running,
+    // then one per period. If this callback was delivered late enough that an
+    // expiration was missed, catch the packet counter up with the time so it
+    // stays in step with the position.
+    elapsedHns = (LONGLONG)(KSCONVERT_PERFORMANCE_TIME(qpcFrequency.QuadPart, qpc) - _this->m_ullRunStartTime);
+    expectedPacketCounter = _this->m_llRunStartPacketCounter + elapsedHns / (LONGLONG)_this->m_ullNotificationIntervalHns - 1;
+
+    if (expectedPacketCounter > _this->m_llPacketCounter + 1)
+    {
+        InterlockedExchange64(&_this->m_llPacketCounter, expectedPacketCounter);
+    }
+    else
+    {
+        InterlockedIncrement64(&_this->m_llPacketCounter);
+    }
 
 #ifdef SYSVAD_BTH_BYPASS
     if (_this->m_ScoOpen)
@@ -1502,8 +1520,6 @@ TimerNotifyRT
     }
 #endif  // SYSVAD_BTH_BYPASS
 
-    _this->m_pMiniport->DpcRoutine(qpc.QuadPart, qpcFrequency.QuadPart);
-
     if (_this->m_KsState != KSSTATE_RUN)
     {
         return;
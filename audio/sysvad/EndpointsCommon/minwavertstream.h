@@ -27,7 +27,7 @@ typedef struct _NotificationListEntry
     PKEVENT     NotificationEvent;
 } NotificationListEntry;
 
-KDEFERRED_ROUTINE TimerNotifyRT;
+EXT_CALLBACK TimerNotifyRT;
 
 //=============================================================================
 // Referenced Forward
@@ -55,9 +55,10 @@ class CMiniportWaveRTStream :
 protected:
     PPORTWAVERTSTREAM           m_pPortStream;
     LIST_ENTRY                  m_NotificationList;
-    PKTIMER                     m_pNotificationTimer;
-    PRKDPC                      m_pNotificationDpc;
-    ULONG                       m_ulNotificationIntervalMs;
+    PEX_TIMER                   m_pNotificationTimer;
+    ULONGLONG                   m_ullNotificationIntervalHns;
+    ULONGLONG                   m_ullRunStartTime;
+    LONGLONG                    m_llRunStartPacketCounter;
     ULONG                       m_ulCurrentWritePosition;
     LONG                        m_IsCurrentWritePositionUpdated;
     
@@ -87,7 +88,7 @@ public:
 
     // Friends
     friend class                CMiniportWaveRT;
-    friend KDEFERRED_ROUTINE    TimerNotifyRT;
+    friend EXT_CALLBACK         TimerNotifyRT;
 protected:
     CMiniportWaveRT*            m_pMiniport;
     ULONG                       m_ulPin;
@@ -108,8 +109,10 @@ protected:
     LONGLONG                    m_llPacketCounter;
     ULONGLONG                   m_ullDmaTimeStamp;
     LARGE_INTEGER               m_ullPerformanceCounterFrequency;
-    ULONGLONG                   m_hnsElapsedTimeCarryForward;
+    ULONGLONG                   m_ullDmaMovementCarryForward;
     ULONG                       m_ulDmaMovementRate;
+    ULONGLONG                   m_ullProcessingTicks;
+    ULONGLONG                   m_ullProcessedBytes;
     BOOL                        m_bLfxEnabled;
     PBOOL                       m_pbMuted;
     PLONG                       m_plVolumeLevel;
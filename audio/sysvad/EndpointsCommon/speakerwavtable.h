@@ -835,6 +835,12 @@ PCPROPERTY_ITEM PropertiesSpeakerWaveFilter[] =
         KSPROPERTY_SYSVAD_DEFAULTSTREAMEFFECTS,
         KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
         PropertyHandler_WaveFilter
+    },
+    {
+        &KSPROPSETID_SysVAD,
+        KSPROPERTY_SYSVAD_SAVEDATA_STATISTICS,
+        KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
+        PropertyHandler_WaveFilter
     }
     
 };
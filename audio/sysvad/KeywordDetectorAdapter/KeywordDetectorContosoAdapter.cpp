@@ -161,8 +161,8 @@ public:
         *LangId = 0x0409;
         *pIsUserMatch = FALSE;
 
-        *KeywordStartPerformanceCounterValue = 0;
-        *KeywordEndPerformanceCounterValue = 0;
+        *KeywordStartPerformanceCounterValue = contosoResult->KeywordStartPerformanceCounter;
+        *KeywordEndPerformanceCounterValue = contosoResult->KeywordEndPerformanceCounter;
 
         return S_OK;
     }
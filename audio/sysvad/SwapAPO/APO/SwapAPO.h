@@ -16,6 +16,8 @@
 #include <commonmacros.h>
 #include <devicetopology.h>
 
+#include "SwapKernels.h"
+
 _Analysis_mode_(_Analysis_code_type_user_driver_)
 
 #define PK_EQUAL(x, y)  ((x.fmtid == y.fmtid) && (x.pid == y.pid))
@@ -60,7 +62,9 @@ public:
     ,   m_AudioProcessingMode(AUDIO_SIGNALPROCESSINGMODE_DEFAULT)
     ,   m_fEnableSwapMFX(FALSE)
     ,   m_fEnableDelayMFX(FALSE)
+    ,   m_pKernels(NULL)
     ,   m_nDelayFrames(0)
+    ,   m_nDelaySamplesAllocated(0)
     ,   m_iDelayIndex(0)
     {
         m_pf32Coefficients = NULL;
@@ -147,11 +151,15 @@ public:
     CComPtr<IMMDeviceEnumerator>            m_spEnumerator;
     static const CRegAPOProperties<1>       sm_RegProperties;   // registration properties
 
-    // Locked memory
+    // Kernels chosen for this processor at LockForProcess
+    const SWAP_KERNELS                      *m_pKernels;
+
+    // Locked memory: SWAP_COEFFICIENT_FRAMES frames of coefficients
     FLOAT32                                 *m_pf32Coefficients;
 
     CComHeapPtr<FLOAT32>                    m_pf32DelayBuffer;
     UINT32                                  m_nDelayFrames;
+    UINT32                                  m_nDelaySamplesAllocated;
     UINT32                                  m_iDelayIndex;
 
 private:
@@ -182,7 +190,9 @@ public:
     ,   m_AudioProcessingMode(AUDIO_SIGNALPROCESSINGMODE_DEFAULT)
     ,   m_fEnableSwapSFX(FALSE)
     ,   m_fEnableDelaySFX(FALSE)
+    ,   m_pKernels(NULL)
     ,   m_nDelayFrames(0)
+    ,   m_nDelaySamplesAllocated(0)
     ,   m_iDelayIndex(0)
     {
     }
@@ -256,8 +266,12 @@ public:
     CCriticalSection                        m_EffectsLock;
     HANDLE                                  m_hEffectsChangedEvent;
 
+    // Kernels chosen for this processor at LockForProcess
+    const SWAP_KERNELS                      *m_pKernels;
+
     CComHeapPtr<FLOAT32>                    m_pf32DelayBuffer;
     UINT32                                  m_nDelayFrames;
+    UINT32                                  m_nDelaySamplesAllocated;
     UINT32                                  m_iDelayIndex;
 };
 #pragma AVRT_VTABLES_END
@@ -269,6 +283,7 @@ OBJECT_ENTRY_AUTO(__uuidof(SwapAPOSFX), CSwapAPOSFX)
 //   Declaration of the ProcessSwap routine.
 //
 void ProcessSwap(
+    _In_ const SWAP_KERNELS *pKernels,
     FLOAT32 *pf32OutputFrames,
     const FLOAT32 *pf32InputFrames,
     UINT32   u32ValidFrameCount,
@@ -278,16 +293,18 @@ void ProcessSwap(
 //   Declaration of the ProcessSwapScale routine.
 //
 void ProcessSwapScale(
+    _In_ const SWAP_KERNELS *pKernels,
     FLOAT32 *pf32OutputFrames,
     const FLOAT32 *pf32InputFrames,
     UINT32   u32ValidFrameCount,
     UINT32   u32SamplesPerFrame,
-    FLOAT32 *pf32Coefficients );
+    const FLOAT32 *pf32CoefficientRun );
 
 //
 //   Declaration of the ProcessDelay routine.
 //
 void ProcessDelay(
+    _In_ const SWAP_KERNELS *pKernels,
     _Out_writes_(u32ValidFrameCount * u32SamplesPerFrame)
         FLOAT32 *pf32OutputFrames,
     _In_reads_(u32ValidFrameCount * u32SamplesPerFrame)
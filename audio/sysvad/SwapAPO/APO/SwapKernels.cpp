@@ -0,0 +1,548 @@
+//
+// SwapKernels.cpp -- Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Description:
+//
+//  Implementation of the channel swap and delay line kernels
+//
+//  The kernels use unaligned loads and stores, since the audio engine gives
+//  no alignment guarantee for connection buffers beyond that of a FLOAT32.
+//  Each vector holds a whole number of sample pairs, so a pair never
+//  straddles two vectors as long as a block starts on a frame; the tail of
+//  a block that does not fill a vector is done by the portable C code.
+//
+#include <atlbase.h>
+#include <atlcom.h>
+#include <atlcoll.h>
+#include <atlsync.h>
+#include <mmreg.h>
+
+#include <audioenginebaseapo.h>
+#include <baseaudioprocessingobject.h>
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <intrin.h>
+#include <immintrin.h>
+#define SWAP_KERNELS_X86
+#elif defined(_M_ARM64)
+#include <arm64_neon.h>
+#define SWAP_KERNELS_NEON
+#elif defined(_M_ARM)
+#include <arm_neon.h>
+#define SWAP_KERNELS_NEON
+#endif
+
+#include "SwapKernels.h"
+
+//-------------------------------------------------------------------------
+// Portable C kernels. Also used for the tail of the vector kernels.
+//
+#pragma AVRT_CODE_BEGIN
+static void SwapC(
+    FLOAT32         *pf32Output,
+    const FLOAT32   *pf32Input,
+    UINT32          u32SampleCount )
+{
+    FLOAT32 f32Swap;
+
+    for (UINT32 i = 0; i + 1 < u32SampleCount; i += 2)
+    {
+        f32Swap = pf32Input[i];
+        pf32Output[i] = pf32Input[i + 1];
+        pf32Output[i + 1] = f32Swap;
+    }
+}
+
+static void SwapScaleC(
+    FLOAT32         *pf32Output,
+    const FLOAT32   *pf32Input,
+    const FLOAT32   *pf32Coefficients,
+    UINT32          u32SampleCount )
+{
+    FLOAT32 f32Swap;
+
+    for (UINT32 i = 0; i + 1 < u32SampleCount; i += 2)
+    {
+        f32Swap = pf32Input[i];
+        pf32Output[i] = pf32Input[i + 1] * pf32Coefficients[i];
+        pf32Output[i + 1] = f32Swap * pf32Coefficients[i + 1];
+    }
+}
+
+static void DelayC(
+    FLOAT32         *pf32Output,
+    const FLOAT32   *pf32Input,
+    FLOAT32         *pf32Delay,
+    UINT32          u32SampleCount )
+{
+    FLOAT32 f32Delayed;
+
+    for (UINT32 i = 0; i < u32SampleCount; i++)
+    {
+        f32Delayed = pf32Delay[i];
+        pf32Delay[i] = pf32Input[i];
+        pf32Output[i] = f32Delayed;
+    }
+}
+#pragma AVRT_CODE_END
+
+#ifdef SWAP_KERNELS_X86
+
+//-------------------------------------------------------------------------
+// SSE kernels, 4 samples per vector.
+//
+#pragma AVRT_CODE_BEGIN
+static void SwapSse(
+    FLOAT32         *pf32Output,
+    const FLOAT32   *pf32Input,
+    UINT32          u32SampleCount )
+{
+    UINT32 i = 0;
+
+    for (; i + 4 <= u32SampleCount; i += 4)
+    {
+        __m128 v = _mm_loadu_ps(pf32Input + i);
+        _mm_storeu_ps(pf32Output + i, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+    }
+
+    SwapC(pf32Output + i, pf32Input + i, u32SampleCount - i);
+}
+
+static void SwapScaleSse(
+    FLOAT32         *pf32Output,
+    const FLOAT32   *pf32Input,
+    const FLOAT32   *pf32Coefficients,
+    UINT32          u32SampleCount )
+{
+    UINT32 i = 0;
+
+    for (; i + 4 <= u32SampleCount; i += 4)
+    {
+        __m128 v = _mm_loadu_ps(pf32Input + i);
+        v = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+        _mm_storeu_ps(pf32Output + i, _mm_mul_ps(v, _mm_loadu_ps(pf32Coefficients + i)));
+    }
+
+    SwapScaleC(pf32Output + i, pf32Input + i, pf32Coefficients + i, u32SampleCount - i);
+}
+
+static void DelaySse(
+    FLOAT32         *pf32Output,
+    const FLOAT32   *pf32Input,
+    FLOAT32         *pf32Delay,
+    UINT32          u32SampleCount )
+{
+    UINT32 i = 0;
+
+    for (; i + 4 <= u32SampleCount; i += 4)
+    {
+        __m128 vDelayed = _mm_loadu_ps(pf32Delay + i);
+        _mm_storeu_ps(pf32Delay + i, _mm_loadu_ps(pf32Input + i));
+        _mm_storeu_ps(pf32Output + i, vDelayed);
+    }
+
+    DelayC(pf32Output + i, pf32Input + i, pf32Delay + i, u32SampleCount - i);
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// AVX kernels, 8 samples per vector. The upper halves of the registers are
+// cleared before the C tail runs, so no SSE code after the kernel pays the
+// AVX to SSE transition penalty.
+//
+#pragma AVRT_CODE_BEGIN
+static void SwapAvx(
+    FLOAT32         *pf32Output,
+    const FLOAT32   *pf32Input,
+    UINT32          u32SampleCount )
+{
+    UINT32 i = 0;
+
+    for (; i + 8 <= u32SampleCount; i += 8)
+    {
+        __m256 v = _mm256_loadu_ps(pf32Input + i);
+        _mm256_storeu_ps(pf32Output + i, _mm256_permute_ps(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    }
+
+    _mm256_zeroupper();
+
+    SwapC(pf32Output + i, pf32Input + i, u32SampleCount - i);
+}
+
+static void SwapScaleAvx(
+    FLOAT32         *pf32Output,
+    const FLOAT32   *pf32Input,
+    const FLOAT32   *pf32Coefficients,
+    UINT32          u32SampleCount )
+{
+    UINT32 i = 0;
+
+    for (; i + 8 <= u32SampleCount; i += 8)
+    {
+        __m256 v = _mm256_loadu_ps(pf32Input + i);
+        v = _mm256_permute_ps(v, _MM_SHUFFLE(2, 3, 0, 1));
+        _mm256_storeu_ps(pf32Output + i, _mm256_mul_ps(v, _mm256_loadu_ps(pf32Coefficients + i)));
+    }
+
+    _mm256_zeroupper();
+
+    SwapScaleC(pf32Output + i, pf32Input + i, pf32Coefficients + i, u32SampleCount - i);
+}
+
+static void DelayAvx(
+    FLOAT32         *pf32Output,
+    const FLOAT32   *pf32Input,
+    FLOAT32         *pf32Delay,
+    UINT32          u32SampleCount )
+{
+    UINT32 i = 0;
+
+    for (; i + 8 <= u32SampleCount; i += 8)
+    {
+        __m256 vDelayed = _mm256_loadu_ps(pf32Delay + i);
+        _mm256_storeu_ps(pf32Delay + i, _mm256_loadu_ps(pf32Input + i));
+        _mm256_storeu_ps(pf32Output + i, vDelayed);
+    }
+
+    _mm256_zeroupper();
+
+    DelayC(pf32Output + i, pf32Input + i, pf32Delay + i, u32SampleCount - i);
+}
+#pragma AVRT_CODE_END
+
+#endif // SWAP_KERNELS_X86
+
+#ifdef SWAP_KERNELS_NEON
+
+//-------------------------------------------------------------------------
+// NEON kernels, 4 samples per vector. vrev64q_f32 reverses the two samples
+// of each 64-bit half, which is the pair swap.
+//
+#pragma AVRT_CODE_BEGIN
+static void SwapNeon(
+    FLOAT32         *pf32Output,
+    const FLOAT32   *pf32Input,
+    UINT32          u32SampleCount )
+{
+    UINT32 i = 0;
+
+    for (; i + 4 <= u32SampleCount; i += 4)
+    {
+        vst1q_f32(pf32Output + i, vrev64q_f32(vld1q_f32(pf32Input + i)));
+    }
+
+    SwapC(pf32Output + i, pf32Input + i, u32SampleCount - i);
+}
+
+static void SwapScaleNeon(
+    FLOAT32         *pf32Output,
+    const FLOAT32   *pf32Input,
+    const FLOAT32   *pf32Coefficients,
+    UINT32          u32SampleCount )
+{
+    UINT32 i = 0;
+
+    for (; i + 4 <= u32SampleCount; i += 4)
+    {
+        float32x4_t v = vrev64q_f32(vld1q_f32(pf32Input + i));
+        vst1q_f32(pf32Output + i, vmulq_f32(v, vld1q_f32(pf32Coefficients + i)));
+    }
+
+    SwapScaleC(pf32Output + i, pf32Input + i, pf32Coefficients + i, u32SampleCount - i);
+}
+
+static void DelayNeon(
+    FLOAT32         *pf32Output,
+    const FLOAT32   *pf32Input,
+    FLOAT32         *pf32Delay,
+    UINT32          u32SampleCount )
+{
+    UINT32 i = 0;
+
+    for (; i + 4 <= u32SampleCount; i += 4)
+    {
+        float32x4_t vDelayed = vld1q_f32(pf32Delay + i);
+        vst1q_f32(pf32Delay + i, vld1q_f32(pf32Input + i));
+        vst1q_f32(pf32Output + i, vDelayed);
+    }
+
+    DelayC(pf32Output + i, pf32Input + i, pf32Delay + i, u32SampleCount - i);
+}
+#pragma AVRT_CODE_END
+
+#endif // SWAP_KERNELS_NEON
+
+//-------------------------------------------------------------------------
+// Kernel sets
+//
+static const SWAP_KERNELS s_KernelsC    = { L"C",    SwapC,    SwapScaleC,    DelayC    };
+#ifdef SWAP_KERNELS_X86
+static const SWAP_KERNELS s_KernelsSse  = { L"SSE",  SwapSse,  SwapScaleSse,  DelaySse  };
+static const SWAP_KERNELS s_KernelsAvx  = { L"AVX",  SwapAvx,  SwapScaleAvx,  DelayAvx  };
+#endif
+#ifdef SWAP_KERNELS_NEON
+static const SWAP_KERNELS s_KernelsNeon = { L"NEON", SwapNeon, SwapScaleNeon, DelayNeon };
+#endif
+
+#ifdef SWAP_KERNELS_X86
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Checks that the processor has AVX and that the OS saves the YMM state.
+//
+static bool IsAvxUsable()
+{
+    int cpuInfo[4];
+
+    __cpuid(cpuInfo, 1);
+
+    const int fOsXsave = (1 << 27);
+    const int fAvx     = (1 << 28);
+
+    if ((cpuInfo[2] & (fOsXsave | fAvx)) != (fOsXsave | fAvx))
+    {
+        return false;
+    }
+
+    // XMM and YMM state enabled in XCR0
+    return ((_xgetbv(0) & 0x6) == 0x6);
+}
+#endif
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Enumerates the kernel sets this processor can run.
+//
+// Parameters:
+//
+//      u32Index                    - [in] index of the set, 0 is the portable C set
+//
+// Return values:
+//
+//      The kernel set, or NULL if u32Index is past the last set
+//
+const SWAP_KERNELS *EnumSwapKernels(
+    UINT32 u32Index )
+{
+    ASSERT_NONREALTIME();
+
+    const SWAP_KERNELS *pKernels[3];
+    UINT32 u32Count = 0;
+
+    pKernels[u32Count++] = &s_KernelsC;
+
+#ifdef SWAP_KERNELS_X86
+#ifdef _M_IX86
+    if (IsProcessorFeaturePresent(PF_XMMI_INSTRUCTIONS_AVAILABLE))
+#endif
+    {
+        pKernels[u32Count++] = &s_KernelsSse;
+
+        if (IsAvxUsable())
+        {
+            pKernels[u32Count++] = &s_KernelsAvx;
+        }
+    }
+#endif
+
+#ifdef SWAP_KERNELS_NEON
+    pKernels[u32Count++] = &s_KernelsNeon;
+#endif
+
+    return (u32Index < u32Count) ? pKernels[u32Index] : NULL;
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Returns the last, preferred, kernel set of EnumSwapKernels.
+//
+const SWAP_KERNELS *SelectSwapKernels()
+{
+    ASSERT_NONREALTIME();
+
+    const SWAP_KERNELS *pSelected = &s_KernelsC;
+    const SWAP_KERNELS *pKernels;
+
+    for (UINT32 i = 0; (pKernels = EnumSwapKernels(i)) != NULL; i++)
+    {
+        pSelected = pKernels;
+    }
+
+    return pSelected;
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Copies the coefficients in the first frame of a coefficient run to the
+//  other SWAP_COEFFICIENT_FRAMES - 1 frames, so the swap-scale kernel can
+//  walk the coefficients with the same index as the samples.
+//
+void FillCoefficientRun(
+    _Inout_updates_(SWAP_COEFFICIENT_FRAMES * u32SamplesPerFrame)
+        FLOAT32 *pf32CoefficientRun,
+    UINT32 u32SamplesPerFrame )
+{
+    ASSERT_NONREALTIME();
+
+    for (UINT32 u32Frame = 1; u32Frame < SWAP_COEFFICIENT_FRAMES; u32Frame++)
+    {
+        CopyMemory(pf32CoefficientRun + u32Frame * u32SamplesPerFrame,
+                   pf32CoefficientRun,
+                   sizeof(FLOAT32) * u32SamplesPerFrame);
+    }
+}
+
+#pragma AVRT_CODE_BEGIN
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Swaps the channels of each stereo pair of the frames.
+//
+// Remarks:
+//
+//  With an even channel count the frames are one run of pairs and are
+//  swapped with a single kernel call. With an odd channel count the last
+//  channel of each frame is not part of a pair and is copied as is.
+//
+void SwapFrames(
+    _In_ const SWAP_KERNELS *pKernels,
+    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
+        FLOAT32 *pf32OutputFrames,
+    _In_reads_(u32FrameCount * u32SamplesPerFrame)
+        const FLOAT32 *pf32InputFrames,
+    UINT32 u32FrameCount,
+    UINT32 u32SamplesPerFrame )
+{
+    if ((u32SamplesPerFrame & 1) == 0)
+    {
+        pKernels->pfnSwap(pf32OutputFrames, pf32InputFrames, u32FrameCount * u32SamplesPerFrame);
+        return;
+    }
+
+    while (u32FrameCount--)
+    {
+        pKernels->pfnSwap(pf32OutputFrames, pf32InputFrames, u32SamplesPerFrame - 1);
+        pf32OutputFrames[u32SamplesPerFrame - 1] = pf32InputFrames[u32SamplesPerFrame - 1];
+
+        pf32OutputFrames += u32SamplesPerFrame;
+        pf32InputFrames += u32SamplesPerFrame;
+    }
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Swaps the channels of each stereo pair of the frames and scales every
+//  output channel by its coefficient.
+//
+// Remarks:
+//
+//  The frames are processed SWAP_COEFFICIENT_FRAMES at a time against the
+//  coefficient run. With an odd channel count the last channel of each
+//  frame is not part of a pair and is copied as is.
+//
+void SwapScaleFrames(
+    _In_ const SWAP_KERNELS *pKernels,
+    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
+        FLOAT32 *pf32OutputFrames,
+    _In_reads_(u32FrameCount * u32SamplesPerFrame)
+        const FLOAT32 *pf32InputFrames,
+    UINT32 u32FrameCount,
+    UINT32 u32SamplesPerFrame,
+    _In_reads_(SWAP_COEFFICIENT_FRAMES * u32SamplesPerFrame)
+        const FLOAT32 *pf32CoefficientRun )
+{
+    if ((u32SamplesPerFrame & 1) == 0)
+    {
+        UINT32 u32RunSamples = SWAP_COEFFICIENT_FRAMES * u32SamplesPerFrame;
+
+        while (u32FrameCount >= SWAP_COEFFICIENT_FRAMES)
+        {
+            pKernels->pfnSwapScale(pf32OutputFrames, pf32InputFrames, pf32CoefficientRun, u32RunSamples);
+
+            pf32OutputFrames += u32RunSamples;
+            pf32InputFrames += u32RunSamples;
+            u32FrameCount -= SWAP_COEFFICIENT_FRAMES;
+        }
+
+        if (u32FrameCount > 0)
+        {
+            pKernels->pfnSwapScale(pf32OutputFrames, pf32InputFrames, pf32CoefficientRun,
+                                   u32FrameCount * u32SamplesPerFrame);
+        }
+        return;
+    }
+
+    while (u32FrameCount--)
+    {
+        pKernels->pfnSwapScale(pf32OutputFrames, pf32InputFrames, pf32CoefficientRun, u32SamplesPerFrame - 1);
+        pf32OutputFrames[u32SamplesPerFrame - 1] = pf32InputFrames[u32SamplesPerFrame - 1];
+
+        pf32OutputFrames += u32SamplesPerFrame;
+        pf32InputFrames += u32SamplesPerFrame;
+    }
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Runs the frames through the delay line: the output gets the frames
+//  that went in u32DelayFrames earlier and the delay line keeps the input.
+//
+// Remarks:
+//
+//  The input and output may be the same buffer.
+//
+//  Invariants:
+//  0 <= (*pu32DelayIndex) < u32DelayFrames
+//
+void DelayFrames(
+    _In_ const SWAP_KERNELS *pKernels,
+    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
+        FLOAT32 *pf32OutputFrames,
+    _In_reads_(u32FrameCount * u32SamplesPerFrame)
+        const FLOAT32 *pf32InputFrames,
+    UINT32 u32FrameCount,
+    UINT32 u32SamplesPerFrame,
+    _Inout_updates_(u32DelayFrames * u32SamplesPerFrame)
+        FLOAT32 *pf32DelayBuffer,
+    UINT32 u32DelayFrames,
+    _Inout_
+        UINT32 *pu32DelayIndex )
+{
+    if (u32DelayFrames == 0)
+    {
+        if (pf32OutputFrames != pf32InputFrames)
+        {
+            CopyMemory(pf32OutputFrames, pf32InputFrames, sizeof(FLOAT32) * u32FrameCount * u32SamplesPerFrame);
+        }
+        return;
+    }
+
+    while (u32FrameCount > 0)
+    {
+        // exchange either the rest of the input/output buffer,
+        // or the rest of the delay buffer,
+        // whichever is smaller
+        UINT32 framesToCopy = min(u32FrameCount, u32DelayFrames - (*pu32DelayIndex));
+
+        pKernels->pfnDelay(pf32OutputFrames,
+                           pf32InputFrames,
+                           &pf32DelayBuffer[(*pu32DelayIndex) * u32SamplesPerFrame],
+                           framesToCopy * u32SamplesPerFrame);
+
+        pf32OutputFrames += framesToCopy * u32SamplesPerFrame;
+        pf32InputFrames += framesToCopy * u32SamplesPerFrame;
+        u32FrameCount -= framesToCopy;
+
+        *pu32DelayIndex += framesToCopy;
+        if (*pu32DelayIndex == u32DelayFrames)
+        {
+            *pu32DelayIndex = 0;
+        }
+    }
+}
+#pragma AVRT_CODE_END
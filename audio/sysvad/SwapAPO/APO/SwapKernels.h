@@ -0,0 +1,114 @@
+//
+// SwapKernels.h -- Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Description:
+//
+//   Declaration of the channel swap and delay line kernels.
+//
+//   The kernels move samples with the widest vector instructions the
+//   processor has. ProcessSwap, ProcessSwapScale and ProcessDelay take the
+//   set to use; the APOs pick it once, in LockForProcess. Every set gives
+//   bit-identical output.
+//
+
+#pragma once
+
+//
+// Frames covered by the coefficient run of SwapScaleFrames. For any channel
+// count, this many frames is a whole number of the widest vectors (8 floats).
+//
+#define SWAP_COEFFICIENT_FRAMES     8
+
+//
+// Swaps the samples of each pair: out[2n] = in[2n+1], out[2n+1] = in[2n].
+//
+typedef void (*PFN_SWAP_KERNEL)(
+    FLOAT32         *pf32Output,
+    const FLOAT32   *pf32Input,
+    UINT32          u32SampleCount );
+
+//
+// Swaps the samples of each pair and multiplies by the coefficient of the
+// output sample.
+//
+typedef void (*PFN_SWAP_SCALE_KERNEL)(
+    FLOAT32         *pf32Output,
+    const FLOAT32   *pf32Input,
+    const FLOAT32   *pf32Coefficients,
+    UINT32          u32SampleCount );
+
+//
+// Exchanges a stretch of the delay line with the signal: out = delay,
+// delay = in. The output may be the input buffer.
+//
+typedef void (*PFN_DELAY_KERNEL)(
+    FLOAT32         *pf32Output,
+    const FLOAT32   *pf32Input,
+    FLOAT32         *pf32Delay,
+    UINT32          u32SampleCount );
+
+typedef struct _SWAP_KERNELS
+{
+    PCWSTR                  pwszName;
+    PFN_SWAP_KERNEL         pfnSwap;
+    PFN_SWAP_SCALE_KERNEL   pfnSwapScale;
+    PFN_DELAY_KERNEL        pfnDelay;
+} SWAP_KERNELS;
+
+//
+// Returns the u32Index'th kernel set this processor can run, from the
+// portable C set up to the preferred one, or NULL past the last set.
+//
+const SWAP_KERNELS *EnumSwapKernels(
+    UINT32 u32Index );
+
+//
+// Returns the preferred kernel set of this processor.
+//
+const SWAP_KERNELS *SelectSwapKernels();
+
+//
+// Frame level routines. Frames with an odd channel count keep their last
+// channel as is.
+//
+void SwapFrames(
+    _In_ const SWAP_KERNELS *pKernels,
+    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
+        FLOAT32 *pf32OutputFrames,
+    _In_reads_(u32FrameCount * u32SamplesPerFrame)
+        const FLOAT32 *pf32InputFrames,
+    UINT32 u32FrameCount,
+    UINT32 u32SamplesPerFrame );
+
+void SwapScaleFrames(
+    _In_ const SWAP_KERNELS *pKernels,
+    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
+        FLOAT32 *pf32OutputFrames,
+    _In_reads_(u32FrameCount * u32SamplesPerFrame)
+        const FLOAT32 *pf32InputFrames,
+    UINT32 u32FrameCount,
+    UINT32 u32SamplesPerFrame,
+    _In_reads_(SWAP_COEFFICIENT_FRAMES * u32SamplesPerFrame)
+        const FLOAT32 *pf32CoefficientRun );
+
+void DelayFrames(
+    _In_ const SWAP_KERNELS *pKernels,
+    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
+        FLOAT32 *pf32OutputFrames,
+    _In_reads_(u32FrameCount * u32SamplesPerFrame)
+        const FLOAT32 *pf32InputFrames,
+    UINT32 u32FrameCount,
+    UINT32 u32SamplesPerFrame,
+    _Inout_updates_(u32DelayFrames * u32SamplesPerFrame)
+        FLOAT32 *pf32DelayBuffer,
+    UINT32 u32DelayFrames,
+    _Inout_
+        UINT32 *pu32DelayIndex );
+
+//
+// Completes a coefficient run whose first frame holds the coefficients.
+//
+void FillCoefficientRun(
+    _Inout_updates_(SWAP_COEFFICIENT_FRAMES * u32SamplesPerFrame)
+        FLOAT32 *pf32CoefficientRun,
+    UINT32 u32SamplesPerFrame );
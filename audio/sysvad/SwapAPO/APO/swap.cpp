@@ -18,6 +18,7 @@
 #include <float.h>
 
 #include "SwapAPO.h"
+#include "SwapKernels.h"
 
 #pragma AVRT_CODE_BEGIN
 void WriteSilence(
@@ -45,77 +46,56 @@ void CopyFrames(
 
 #pragma AVRT_CODE_BEGIN
 void ProcessSwap(
+    _In_ const SWAP_KERNELS *pKernels,
     FLOAT32 *pf32OutputFrames,
     const FLOAT32 *pf32InputFrames,
     UINT32   u32ValidFrameCount,
     UINT32   u32SamplesPerFrame )
 {
-    UINT32   u32SampleIndex;
-    FLOAT32  fSwap32;
-
     ASSERT_REALTIME();
+    ATLASSERT( IS_VALID_TYPED_READ_POINTER(pKernels) );
     ATLASSERT( IS_VALID_TYPED_READ_POINTER(pf32InputFrames) );
     ATLASSERT( IS_VALID_TYPED_WRITE_POINTER(pf32OutputFrames) );
 
-    // loop through samples
-    while (u32ValidFrameCount--)
-    {
-        for (u32SampleIndex=0; u32SampleIndex+1<u32SamplesPerFrame; u32SampleIndex += 2)
-        {
-            // apply swap
-            fSwap32 = *pf32InputFrames;
-            *pf32OutputFrames = *(pf32InputFrames + 1);
-            pf32OutputFrames++;
-            *pf32OutputFrames = fSwap32;
-            pf32OutputFrames++;
-            pf32InputFrames += 2;
-        }
-    }
+    SwapFrames( pKernels,
+                pf32OutputFrames,
+                pf32InputFrames,
+                u32ValidFrameCount,
+                u32SamplesPerFrame );
 }
 #pragma AVRT_CODE_END
 
 
 #pragma AVRT_CODE_BEGIN
 void ProcessSwapScale(
+    _In_ const SWAP_KERNELS *pKernels,
     FLOAT32 *pf32OutputFrames,
     const FLOAT32 *pf32InputFrames,
     UINT32   u32ValidFrameCount,
     UINT32   u32SamplesPerFrame,
-    FLOAT32  *pf32Coefficients )
+    const FLOAT32 *pf32CoefficientRun )
 {
-    UINT32   u32SampleIndex;
-    FLOAT32  fSwap32;
-
     ASSERT_REALTIME();
+    ATLASSERT( IS_VALID_TYPED_READ_POINTER(pKernels) );
     ATLASSERT( IS_VALID_TYPED_READ_POINTER(pf32InputFrames) );
     ATLASSERT( IS_VALID_TYPED_READ_POINTER(pf32OutputFrames) );
-
-    // loop through samples
-    while (u32ValidFrameCount--)
-    {
-        for (u32SampleIndex=0; u32SampleIndex+1<u32SamplesPerFrame; u32SampleIndex += 2)
-        {
-            // apply swap for each stereo pair and scale
-
-            // save left channel
-            fSwap32 = *pf32InputFrames;
-            // left output equals right input times 1st coefficient
-            *pf32OutputFrames = *(pf32InputFrames + 1) * pf32Coefficients[u32SampleIndex];
-            pf32OutputFrames++;
-            
-            // right output equals left input times 2nd coefficient
-            *pf32OutputFrames = fSwap32  * pf32Coefficients[u32SampleIndex+1];      
-            pf32OutputFrames++;
-
-            pf32InputFrames += 2;
-        }
-    }
+    ATLASSERT( IS_VALID_TYPED_READ_POINTER(pf32CoefficientRun) );
+
+    // swap each stereo pair: the left output equals the right input times
+    // the 1st coefficient, the right output the left input times the 2nd
+    SwapScaleFrames( pKernels,
+                     pf32OutputFrames,
+                     pf32InputFrames,
+                     u32ValidFrameCount,
+                     u32SamplesPerFrame,
+                     pf32CoefficientRun );
 }
 #pragma AVRT_CODE_END
 
 
 #pragma AVRT_CODE_BEGIN
 void ProcessDelay(
+    _In_ const SWAP_KERNELS *pKernels,
     _Out_writes_(u32ValidFrameCount * u32SamplesPerFrame)
         FLOAT32 *pf32OutputFrames,
     _In_reads_(u32ValidFrameCount * u32SamplesPerFrame)
@@ -129,55 +109,19 @@ void ProcessDelay(
         UINT32  *pu32DelayIndex )
 {
     ASSERT_REALTIME();
+    ATLASSERT( IS_VALID_TYPED_READ_POINTER(pKernels) );
     ATLASSERT( IS_VALID_TYPED_READ_POINTER(pf32InputFrames) );
     ATLASSERT( IS_VALID_TYPED_READ_POINTER(pf32OutputFrames) );
-    
-    if (u32DelayFrames == 0)
-    {
-        CopyFrames( pf32OutputFrames,
-                    pf32InputFrames,
-                    u32ValidFrameCount,
-                    u32SamplesPerFrame );
-    }
-    else
-    {
-
-        // Invariants:
-        // 0 <= (*pu32DelayIndex) < u32DelayFrames
-        // pf32OutputFrames[0 ... u32ValidFrameCount * u32SamplesPerFrame - 1] is writable
-        // pf32InputFrames[0 ... u32ValidFrameCount * u32SamplesPerFrame - 1] is readable
-        while (u32ValidFrameCount > 0)
-        {
-            // copy either the rest of the input/output buffer,
-            // or the rest of the delay buffer,
-            // whichever is smaller
-            UINT32 framesToCopy = min(u32ValidFrameCount, u32DelayFrames - (*pu32DelayIndex));
-            
-            // delay => output
-#pragma prefast(suppress: __WARNING_POTENTIAL_BUFFER_OVERFLOW_HIGH_PRIORITY, "this copy to pf32OutputFrames is in-range")
-            CopyFrames( pf32OutputFrames,
-                        &pf32DelayBuffer[(*pu32DelayIndex) * u32SamplesPerFrame],
-                        framesToCopy,
-                        u32SamplesPerFrame );
-            
-            // input => delay
-            CopyFrames( &pf32DelayBuffer[(*pu32DelayIndex) * u32SamplesPerFrame],
-                        pf32InputFrames,
-                        framesToCopy,
-                        u32SamplesPerFrame );
 
-            pf32OutputFrames += framesToCopy * u32SamplesPerFrame;
-            pf32InputFrames += framesToCopy * u32SamplesPerFrame;
-            u32ValidFrameCount -= framesToCopy;
-            
-            *pu32DelayIndex += framesToCopy;
-            if (*pu32DelayIndex == u32DelayFrames)
-            {
-                *pu32DelayIndex = 0;
-            }
-        }
-
-    }
+    // the delay line exchanges the frames with the buffer, so the output
+    // may be the input buffer
+    DelayFrames( pKernels,
+                 pf32OutputFrames,
+                 pf32InputFrames,
+                 u32ValidFrameCount,
+                 u32SamplesPerFrame,
+                 pf32DelayBuffer,
+                 u32DelayFrames,
+                 pu32DelayIndex );
 }
 #pragma AVRT_CODE_END
-
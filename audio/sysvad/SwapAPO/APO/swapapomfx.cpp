@@ -176,7 +176,7 @@ STDMETHODIMP_(void) CSwapAPOMFX::APOProcess(
                 (1 < m_u32SamplesPerFrame)
             )
             {
-                ProcessSwapScale(pf32InputFrames, pf32InputFrames,
+                ProcessSwapScale(m_pKernels, pf32InputFrames, pf32InputFrames,
                             ppInputConnections[0]->u32ValidFrameCount,
                             m_u32SamplesPerFrame, m_pf32Coefficients );
             }
@@ -187,7 +187,7 @@ STDMETHODIMP_(void) CSwapAPOMFX::APOProcess(
                 m_fEnableDelayMFX
             )
             {
-                ProcessDelay(pf32OutputFrames, pf32InputFrames,
+                ProcessDelay(m_pKernels, pf32OutputFrames, pf32InputFrames,
                              ppInputConnections[0]->u32ValidFrameCount,
                              GetSamplesPerFrame(),
                              m_pf32DelayBuffer,
@@ -290,27 +290,45 @@ STDMETHODIMP CSwapAPOMFX::LockForProcess(UINT32 u32NumInputConnections,
         ppInputConnections, u32NumOutputConnections, ppOutputConnections);
     IF_FAILED_JUMP(hr, Exit);
     
-    if (!IsEqualGUID(m_AudioProcessingMode, AUDIO_SIGNALPROCESSINGMODE_RAW) && m_fEnableDelayMFX)
+    // Choose the kernels for this processor once; APOProcess only calls
+    // through them.
+    m_pKernels = SelectSwapKernels();
+
+    // The delay line is allocated even while the delay is off, so that the
+    // delay can be switched on while streaming without an allocation or a
+    // buffer sized for an earlier format.
+    if (!IsEqualGUID(m_AudioProcessingMode, AUDIO_SIGNALPROCESSINGMODE_RAW))
     {
+        UINT32 nDelaySamples;
+
         m_nDelayFrames = FRAMES_FROM_HNS(HNS_DELAY);
         m_iDelayIndex = 0;
+        nDelaySamples = GetSamplesPerFrame() * m_nDelayFrames;
 
-        m_pf32DelayBuffer.Free();
-
-        // Allocate one second's worth of audio
-        // 
-        // This allocation is being done using CoTaskMemAlloc because the delay is very large
-        // This introduces a risk of glitches if the delay buffer gets paged out
-        //
-        // A more typical approach would be to allocate the memory using AERT_Allocate, which locks the memory
-        // But for the purposes of this APO, CoTaskMemAlloc suffices, and the risk of glitches is not important
-        m_pf32DelayBuffer.Allocate(GetSamplesPerFrame() * m_nDelayFrames);
-        WriteSilence(m_pf32DelayBuffer, m_nDelayFrames, GetSamplesPerFrame());
-        if (nullptr == m_pf32DelayBuffer)
+        // Keep the buffer of an earlier lock if it is big enough
+        if (m_nDelaySamplesAllocated < nDelaySamples)
         {
-            hr = E_OUTOFMEMORY;
-            goto Exit;
+            m_pf32DelayBuffer.Free();
+            m_nDelaySamplesAllocated = 0;
+
+            // Allocate one second's worth of audio
+            // 
+            // This allocation is being done using CoTaskMemAlloc because the delay is very large
+            // This introduces a risk of glitches if the delay buffer gets paged out
+            //
+            // A more typical approach would be to allocate the memory using AERT_Allocate, which locks the memory
+            // But for the purposes of this APO, CoTaskMemAlloc suffices, and the risk of glitches is not important
+            if (!m_pf32DelayBuffer.Allocate(nDelaySamples))
+            {
+                m_nDelayFrames = 0;
+                hr = E_OUTOFMEMORY;
+                goto Exit;
+            }
+
+            m_nDelaySamplesAllocated = nDelaySamples;
         }
+
+        WriteSilence(m_pf32DelayBuffer, m_nDelayFrames, GetSamplesPerFrame());
     }
     
 Exit:
@@ -872,8 +890,16 @@ HRESULT CSwapAPOMFX::ValidateAndCacheConnectionInfo(UINT32 u32NumInputConnection
     _ASSERTE(UncompOutputFormat.fFramesPerSecond == UncompInputFormat.fFramesPerSecond);
     _ASSERTE(UncompOutputFormat. dwSamplesPerFrame == UncompInputFormat.dwSamplesPerFrame);
 
-    // Allocate some locked memory.  We will use these as scaling coefficients during APOProcess->ProcessSwapScale
-    hResult = AERT_Allocate(sizeof(FLOAT32)*m_u32SamplesPerFrame, (void**)&m_pf32Coefficients);
+    // Free the coefficients of an earlier lock
+    if (NULL != m_pf32Coefficients)
+    {
+        AERT_Free(m_pf32Coefficients);
+        m_pf32Coefficients = NULL;
+    }
+
+    // Allocate some locked memory.  We will use these as scaling coefficients during APOProcess->ProcessSwapScale.
+    // The coefficients of a frame are repeated SWAP_COEFFICIENT_FRAMES times so the kernels can scale whole vectors.
+    hResult = AERT_Allocate(sizeof(FLOAT32)*SWAP_COEFFICIENT_FRAMES*m_u32SamplesPerFrame, (void**)&m_pf32Coefficients);
     IF_FAILED_JUMP(hResult, Exit);
 
     // Set scalars to decrease volume from 1.0 to 1.0/N where N is the number of channels
@@ -883,6 +909,7 @@ HRESULT CSwapAPOMFX::ValidateAndCacheConnectionInfo(UINT32 u32NumInputConnection
     {
         m_pf32Coefficients[u16Index] = 1.0f - (FLOAT32)(f32InverseChannelCount)*u16Index;
     }
+    FillCoefficientRun(m_pf32Coefficients, m_u32SamplesPerFrame);
 
     
 Exit:
@@ -124,7 +124,7 @@ STDMETHODIMP_(void) CSwapAPOSFX::APOProcess(
                 m_fEnableSwapSFX
             )
             {
-                ProcessSwap(pf32InputFrames, pf32InputFrames,
+                ProcessSwap(m_pKernels, pf32InputFrames, pf32InputFrames,
                             ppInputConnections[0]->u32ValidFrameCount,
                             m_u32SamplesPerFrame);
             }
@@ -135,7 +135,7 @@ STDMETHODIMP_(void) CSwapAPOSFX::APOProcess(
                 m_fEnableDelaySFX
             )
             {
-                ProcessDelay(pf32OutputFrames, pf32InputFrames,
+                ProcessDelay(m_pKernels, pf32OutputFrames, pf32InputFrames,
                              ppInputConnections[0]->u32ValidFrameCount,
                              GetSamplesPerFrame(),
                              m_pf32DelayBuffer,
@@ -238,28 +238,45 @@ STDMETHODIMP CSwapAPOSFX::LockForProcess(UINT32 u32NumInputConnections,
         ppInputConnections, u32NumOutputConnections, ppOutputConnections);
     IF_FAILED_JUMP(hr, Exit);
     
-    if (!IsEqualGUID(m_AudioProcessingMode, AUDIO_SIGNALPROCESSINGMODE_RAW) && m_fEnableDelaySFX)
+    // Choose the kernels for this processor once; APOProcess only calls
+    // through them.
+    m_pKernels = SelectSwapKernels();
+
+    // The delay line is allocated even while the delay is off, so that the
+    // delay can be switched on while streaming without an allocation or a
+    // buffer sized for an earlier format.
+    if (!IsEqualGUID(m_AudioProcessingMode, AUDIO_SIGNALPROCESSINGMODE_RAW))
     {
+        UINT32 nDelaySamples;
+
         m_nDelayFrames = FRAMES_FROM_HNS(HNS_DELAY);
         m_iDelayIndex = 0;
+        nDelaySamples = GetSamplesPerFrame() * m_nDelayFrames;
 
-        m_pf32DelayBuffer.Free();
-        
-        // Allocate one second's worth of audio
-        // 
-        // This allocation is being done using CoTaskMemAlloc because the delay is very large
-        // This introduces a risk of glitches if the delay buffer gets paged out
-        //
-        // A more typical approach would be to allocate the memory using AERT_Allocate, which locks the memory
-        // But for the purposes of this APO, CoTaskMemAlloc suffices, and the risk of glitches is not important
-        m_pf32DelayBuffer.Allocate(GetSamplesPerFrame() * m_nDelayFrames);
-                
-        WriteSilence(m_pf32DelayBuffer, m_nDelayFrames, GetSamplesPerFrame());
-        if (nullptr == m_pf32DelayBuffer)
+        // Keep the buffer of an earlier lock if it is big enough
+        if (m_nDelaySamplesAllocated < nDelaySamples)
         {
-            hr = E_OUTOFMEMORY;
-            goto Exit;
+            m_pf32DelayBuffer.Free();
+            m_nDelaySamplesAllocated = 0;
+
+            // Allocate one second's worth of audio
+            // 
+            // This allocation is being done using CoTaskMemAlloc because the delay is very large
+            // This introduces a risk of glitches if the delay buffer gets paged out
+            //
+            // A more typical approach would be to allocate the memory using AERT_Allocate, which locks the memory
+            // But for the purposes of this APO, CoTaskMemAlloc suffices, and the risk of glitches is not important
+            if (!m_pf32DelayBuffer.Allocate(nDelaySamples))
+            {
+                m_nDelayFrames = 0;
+                hr = E_OUTOFMEMORY;
+                goto Exit;
+            }
+
+            m_nDelaySamplesAllocated = nDelaySamples;
         }
+
+        WriteSilence(m_pf32DelayBuffer, m_nDelayFrames, GetSamplesPerFrame());
     }
     
 Exit:
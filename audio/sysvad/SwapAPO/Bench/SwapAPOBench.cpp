@@ -0,0 +1,389 @@
+/*++
+
+Copyright (c) Microsoft Corporation
+
+Module Name:
+
+    SwapAPOBench.cpp
+
+Abstract:
+
+    A benchmark for the processing routines of the SwapAPO sample.
+
+    APOProcess of the MFX swaps and scales the channels and then runs the
+    frames through the delay line; APOProcess of the SFX swaps and then
+    runs them through the delay line. The benchmark times both paths with
+    every kernel set the processor can run, for a range of channel counts,
+    sample rates and frame counts, and checks that each set gives the same
+    output as the portable C set.
+
+    The routines are called directly, with the buffers APOProcess would
+    get, rather than through an APO instance: creating and locking the APO
+    takes the property stores and media types of a real audio endpoint.
+
+
+Environment:
+
+    user mode only
+
+--*/
+
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_code_)
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <audioenginebaseapo.h>
+
+#include "SwapKernels.h"
+
+#define DEFAULT_MILLISECONDS    200
+
+//
+// Delay line used to check the kernels. It is kept short so the checks
+// wrap around it several times.
+//
+#define CHECK_DELAY_FRAMES      7
+#define CHECK_PASSES            5
+
+static const UINT32 g_Channels[]    = { 1, 2, 6, 8 };
+static const UINT32 g_Rates[]       = { 44100, 48000, 96000, 192000 };
+static const UINT32 g_FrameCounts[] = { 128, 441, 480, 1024, 4096 };
+
+typedef enum _BENCH_PATH {
+    BenchPathMfx,
+    BenchPathSfx
+} BENCH_PATH;
+
+//
+// Buffers of one case, laid out as APOProcess sees them.
+//
+typedef struct _BENCH_BUFFERS {
+    UINT32      Channels;
+    UINT32      Frames;
+    UINT32      DelayFrames;
+    UINT32      DelayIndex;
+    FLOAT32     *Source;
+    FLOAT32     *Work;
+    FLOAT32     *Output;
+    FLOAT32     *Delay;
+    FLOAT32     Coefficients[SWAP_COEFFICIENT_FRAMES * 8];
+} BENCH_BUFFERS, *PBENCH_BUFFERS;
+
+LARGE_INTEGER g_Frequency;
+
+
+static
+FLOAT32 *
+AllocateSamples(
+    _In_ UINT32 Count
+    )
+{
+    return (FLOAT32 *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(FLOAT32) * Count);
+}
+
+static
+VOID
+FreeBuffers(
+    _Inout_ PBENCH_BUFFERS Buffers
+    )
+{
+    if (Buffers->Source != NULL) {
+        HeapFree(GetProcessHeap(), 0, Buffers->Source);
+    }
+    if (Buffers->Work != NULL) {
+        HeapFree(GetProcessHeap(), 0, Buffers->Work);
+    }
+    if (Buffers->Output != NULL) {
+        HeapFree(GetProcessHeap(), 0, Buffers->Output);
+    }
+    if (Buffers->Delay != NULL) {
+        HeapFree(GetProcessHeap(), 0, Buffers->Delay);
+    }
+
+    ZeroMemory(Buffers, sizeof(*Buffers));
+}
+
+//
+// AllocateBuffers
+//
+// Allocates the buffers of a case and fills the source with noise. The
+// coefficients are the ones CSwapAPOMFX computes for the channel count.
+//
+static
+BOOL
+AllocateBuffers(
+    _Out_ PBENCH_BUFFERS Buffers,
+    _In_ UINT32 Channels,
+    _In_ UINT32 Frames,
+    _In_ UINT32 DelayFrames
+    )
+{
+    UINT32 i;
+    UINT32 Seed = 0x12345678;
+
+    ZeroMemory(Buffers, sizeof(*Buffers));
+
+    Buffers->Channels = Channels;
+    Buffers->Frames = Frames;
+    Buffers->DelayFrames = DelayFrames;
+
+    Buffers->Source = AllocateSamples(Frames * Channels);
+    Buffers->Work = AllocateSamples(Frames * Channels);
+    Buffers->Output = AllocateSamples(Frames * Channels);
+    Buffers->Delay = AllocateSamples(DelayFrames * Channels);
+
+    if (Buffers->Source == NULL || Buffers->Work == NULL ||
+        Buffers->Output == NULL || Buffers->Delay == NULL) {
+        FreeBuffers(Buffers);
+        return FALSE;
+    }
+
+    for (i = 0; i < Frames * Channels; i++) {
+        Seed = Seed * 1664525 + 1013904223;
+        Buffers->Source[i] = (FLOAT32)(INT32)Seed / 2147483648.0f;
+    }
+
+    for (i = 0; i < Channels; i++) {
+        Buffers->Coefficients[i] = 1.0f - (1.0f / Channels) * i;
+    }
+    FillCoefficientRun(Buffers->Coefficients, Channels);
+
+    return TRUE;
+}
+
+//
+// RunPass
+//
+// One APOProcess call's worth of work. The swap goes from the source to
+// a work buffer, rather than in place as in the APO, so repeated passes
+// don't scale the same samples down to denormals.
+//
+static
+VOID
+RunPass(
+    _In_ const SWAP_KERNELS *Kernels,
+    _In_ BENCH_PATH Path,
+    _Inout_ PBENCH_BUFFERS Buffers
+    )
+{
+    if (Path == BenchPathMfx) {
+        SwapScaleFrames(Kernels, Buffers->Work, Buffers->Source,
+                        Buffers->Frames, Buffers->Channels, Buffers->Coefficients);
+    } else {
+        SwapFrames(Kernels, Buffers->Work, Buffers->Source,
+                   Buffers->Frames, Buffers->Channels);
+    }
+
+    DelayFrames(Kernels, Buffers->Output, Buffers->Work,
+                Buffers->Frames, Buffers->Channels,
+                Buffers->Delay, Buffers->DelayFrames, &Buffers->DelayIndex);
+}
+
+//
+// CheckKernels
+//
+// Runs a few passes through a short delay line with Kernels and with the
+// C set, and compares the outputs and delay lines bit for bit.
+//
+static
+BOOL
+CheckKernels(
+    _In_ const SWAP_KERNELS *Kernels,
+    _In_ BENCH_PATH Path,
+    _In_ UINT32 Channels,
+    _In_ UINT32 Frames
+    )
+{
+    BENCH_BUFFERS Expected;
+    BENCH_BUFFERS Actual;
+    BOOL Match = TRUE;
+    UINT32 Pass;
+
+    if (!AllocateBuffers(&Expected, Channels, Frames, CHECK_DELAY_FRAMES)) {
+        return FALSE;
+    }
+    if (!AllocateBuffers(&Actual, Channels, Frames, CHECK_DELAY_FRAMES)) {
+        FreeBuffers(&Expected);
+        return FALSE;
+    }
+
+    for (Pass = 0; Pass < CHECK_PASSES && Match; Pass++) {
+        RunPass(EnumSwapKernels(0), Path, &Expected);
+        RunPass(Kernels, Path, &Actual);
+
+        Match = (memcmp(Expected.Output, Actual.Output, sizeof(FLOAT32) * Frames * Channels) == 0) &&
+                (memcmp(Expected.Delay, Actual.Delay, sizeof(FLOAT32) * CHECK_DELAY_FRAMES * Channels) == 0) &&
+                (Expected.DelayIndex == Actual.DelayIndex);
+    }
+
+    FreeBuffers(&Expected);
+    FreeBuffers(&Actual);
+
+    return Match;
+}
+
+//
+// TimeKernels
+//
+// Returns the average time of a pass in nanoseconds, or a negative value
+// if the buffers can't be allocated.
+//
+static
+double
+TimeKernels(
+    _In_ const SWAP_KERNELS *Kernels,
+    _In_ BENCH_PATH Path,
+    _In_ UINT32 Channels,
+    _In_ UINT32 Rate,
+    _In_ UINT32 Frames,
+    _In_ ULONG Milliseconds
+    )
+{
+    BENCH_BUFFERS Buffers;
+    LARGE_INTEGER Start;
+    LARGE_INTEGER Now;
+    LONGLONG Budget;
+    ULONGLONG Passes = 0;
+    UINT32 i;
+
+    //
+    // The APO's delay line holds one second of audio.
+    //
+
+    if (!AllocateBuffers(&Buffers, Channels, Frames, Rate)) {
+        return -1.0;
+    }
+
+    //
+    // Warm up the caches and the branch predictors.
+    //
+
+    for (i = 0; i < 16; i++) {
+        RunPass(Kernels, Path, &Buffers);
+    }
+
+    Budget = g_Frequency.QuadPart * Milliseconds / 1000;
+
+    QueryPerformanceCounter(&Start);
+
+    do {
+        for (i = 0; i < 16; i++) {
+            RunPass(Kernels, Path, &Buffers);
+        }
+        Passes += 16;
+
+        QueryPerformanceCounter(&Now);
+
+    } while (Now.QuadPart - Start.QuadPart < Budget);
+
+    FreeBuffers(&Buffers);
+
+    return (double)(Now.QuadPart - Start.QuadPart) * 1e9 / (double)g_Frequency.QuadPart / (double)Passes;
+}
+
+static
+VOID
+Usage()
+{
+    printf("Usage: SwapAPOBench.exe [-Milliseconds <n>]\n");
+    printf("    -Milliseconds   time spent on each case (default %d)\n", DEFAULT_MILLISECONDS);
+}
+
+int __cdecl
+main(
+    _In_ int argc,
+    _In_reads_(argc) char* argv[]
+    )
+{
+    ULONG Milliseconds = DEFAULT_MILLISECONDS;
+    const SWAP_KERNELS *Kernels;
+    int Argument;
+    int Failures = 0;
+    UINT32 PathIndex;
+    UINT32 c, r, f, k;
+    double Baseline;
+    double Time;
+
+    for (Argument = 1; Argument < argc; Argument++) {
+        if (_stricmp(argv[Argument], "-Milliseconds") == 0 && Argument + 1 < argc) {
+            Milliseconds = strtoul(argv[++Argument], NULL, 0);
+        } else {
+            Usage();
+            return 1;
+        }
+    }
+
+    if (Milliseconds == 0) {
+        Usage();
+        return 1;
+    }
+
+    QueryPerformanceFrequency(&g_Frequency);
+
+    //
+    // Keep the timing thread on one processor and ahead of the rest of
+    // the system.
+    //
+
+    SetThreadAffinityMask(GetCurrentThread(), 1);
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+
+    printf("Kernel sets:");
+    for (k = 0; (Kernels = EnumSwapKernels(k)) != NULL; k++) {
+        printf(" %ls", Kernels->pwszName);
+    }
+    printf(" (APO uses %ls)\n\n", SelectSwapKernels()->pwszName);
+
+    printf("%-4s %-5s %8s %7s %7s %12s %10s %8s\n",
+           "Path", "Set", "Channels", "Rate", "Frames", "ns/pass", "ns/frame", "vs C");
+
+    for (PathIndex = 0; PathIndex < 2; PathIndex++) {
+        BENCH_PATH Path = (PathIndex == 0) ? BenchPathMfx : BenchPathSfx;
+
+        for (c = 0; c < ARRAYSIZE(g_Channels); c++) {
+            for (r = 0; r < ARRAYSIZE(g_Rates); r++) {
+                for (f = 0; f < ARRAYSIZE(g_FrameCounts); f++) {
+
+                    Baseline = 0.0;
+
+                    for (k = 0; (Kernels = EnumSwapKernels(k)) != NULL; k++) {
+
+                        if (k > 0 && !CheckKernels(Kernels, Path, g_Channels[c], g_FrameCounts[f])) {
+                            printf("%-4s %-5ls %8u %7u %7u    MISMATCH against the C kernels\n",
+                                   Path == BenchPathMfx ? "MFX" : "SFX", Kernels->pwszName,
+                                   g_Channels[c], g_Rates[r], g_FrameCounts[f]);
+                            Failures++;
+                            continue;
+                        }
+
+                        Time = TimeKernels(Kernels, Path, g_Channels[c], g_Rates[r],
+                                           g_FrameCounts[f], Milliseconds);
+                        if (Time < 0.0) {
+                            printf("Out of memory\n");
+                            return 1;
+                        }
+
+                        if (k == 0) {
+                            Baseline = Time;
+                        }
+
+                        printf("%-4s %-5ls %8u %7u %7u %12.1f %10.3f %7.2fx\n",
+                               Path == BenchPathMfx ? "MFX" : "SFX", Kernels->pwszName,
+                               g_Channels[c], g_Rates[r], g_FrameCounts[f],
+                               Time, Time / g_FrameCounts[f], Baseline / Time);
+                    }
+                }
+            }
+        }
+    }
+
+    if (Failures != 0) {
+        printf("\n%d kernel checks failed\n", Failures);
+        return 2;
+    }
+
+    return 0;
+}
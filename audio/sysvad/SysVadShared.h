@@ -24,7 +24,20 @@ DEFINE_GUIDSTRUCT("D849C827-B24B-4C3D-A26E-338F4FF07ED5", KSPROPSETID_SysVAD);
 
 
 typedef enum{
-    KSPROPERTY_SYSVAD_DEFAULTSTREAMEFFECTS
+    KSPROPERTY_SYSVAD_DEFAULTSTREAMEFFECTS,
+    KSPROPERTY_SYSVAD_SAVEDATA_STATISTICS
 } KSPROPERTY_SYSVAD;
 
+//
+// Value of KSPROPERTY_SYSVAD_SAVEDATA_STATISTICS: totals of all the render
+// streams saved to disk since the driver was loaded.
+//
+typedef struct _SYSVAD_SAVEDATA_STATISTICS
+{
+    ULONGLONG   BytesWritten;       // Bytes written to the data files.
+    ULONGLONG   BytesDropped;       // Bytes dropped because a stream buffer was full.
+    ULONG       Overruns;           // Writes dropped because a stream buffer was full.
+    ULONG       FileWrites;         // ZwWriteFile calls made for stream data.
+} SYSVAD_SAVEDATA_STATISTICS, *PSYSVAD_SAVEDATA_STATISTICS;
+
 #endif
@@ -827,6 +827,12 @@ PCPROPERTY_ITEM PropertiesSpdifWaveFilter[] =
         KSPROPERTY_SYSVAD_DEFAULTSTREAMEFFECTS,
         KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
         PropertyHandler_WaveFilter
+    },
+    {
+        &KSPROPSETID_SysVAD,
+        KSPROPERTY_SYSVAD_SAVEDATA_STATISTICS,
+        KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
+        PropertyHandler_WaveFilter
     }
 };
 
@@ -10,11 +10,22 @@ Abstract:
 
     Implementation of SYSVAD sine wave generator
 
+    The file is also built into the user mode benchmark in the Bench
+    directory; Bench\ToneBench.h stands in for sysvad.h there.
+
 
 --*/
+#if defined(_KERNEL_MODE)
 #include <sysvad.h>
+#else
+#include "ToneBench.h"
+#endif
 #include "ToneGenerator.h"
 
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
 const double TONE_AMPLITUDE = 0.5;  // Scalar value, should be between 0.0 - 1.0
 const double TWO_PI = M_PI * 2;
 
@@ -43,13 +54,14 @@ ToneGenerator::ToneGenerator()
   m_ChannelCount(0),
   m_BitsPerSample(0),
   m_SamplesPerSecond(0),
+  m_UseSse2(false),
   m_Mute(false),
   m_PartialFrame(NULL),
   m_PartialFrameBytes(0),
   m_FrameSize(0)
 {
-    // Theta (double) and SampleIncrement (double) are init in the Init() method 
-    // after saving the floating point state. 
+    // Theta (double), SampleIncrement (double) and the rotation (float) are
+    // init in the Init() method after saving the floating point state. 
 }
 
 //
@@ -88,26 +100,218 @@ VOID ToneGenerator::InitNewFrame
         return;
     }
     
+    WriteFrame(Frame, sinValue);
+
+    m_Theta += m_SampleIncrement;
+    if (m_Theta >= TWO_PI)
+    {
+        m_Theta -= TWO_PI;
+    }
+}
+
+//
+// Write the same sample value to all the channels of a frame.
+//
+VOID ToneGenerator::WriteFrame
+(
+    _Out_writes_bytes_(m_FrameSize)  BYTE*  Frame,
+    _In_                             double Value
+)
+{
     for(ULONG i = 0; i < m_ChannelCount; ++i)
     {
         if (m_BitsPerSample == 8)
         {
             unsigned char *dataBuffer = reinterpret_cast<unsigned char *>(Frame);
-             dataBuffer[i] = ConvertToUChar(sinValue);
+             dataBuffer[i] = ConvertToUChar(Value);
         }
         else // 16 bits per sample
         {
             short *dataBuffer = reinterpret_cast<short *>(Frame);
-            dataBuffer[i] = ConvertToShort(sinValue);
+            dataBuffer[i] = ConvertToShort(Value);
         }
     }
+}
 
-    m_Theta += m_SampleIncrement;
-    if (m_Theta >= TWO_PI)
+//
+// Generate whole frames, TONE_LANES at a time.
+//
+// The lanes hold the sine and cosine of TONE_LANES consecutive phases, scaled
+// by the amplitude. Rotating each lane by TONE_LANES sample increments gives
+// the next group of frames with four multiplies and two adds per lane, so
+// sin() is only called when a block is seeded.
+//
+VOID ToneGenerator::GenerateFrames
+(
+    _Out_writes_bytes_(Frames * m_FrameSize) BYTE*  Buffer,
+    _In_                                     size_t Frames
+)
+{
+    float   sinLanes[TONE_LANES];
+    float   cosLanes[TONE_LANES];
+    size_t  blockFrames;
+
+    while (Frames >= TONE_LANES)
     {
-        m_Theta -= TWO_PI;
+        blockFrames = MIN(Frames, TONE_BLOCK_FRAMES) & ~(size_t)(TONE_LANES - 1);
+
+        for (ULONG i = 0; i < TONE_LANES; ++i)
+        {
+            double theta = m_Theta + i * m_SampleIncrement;
+
+            sinLanes[i] = (float)(TONE_AMPLITUDE * sin(theta));
+            cosLanes[i] = (float)(TONE_AMPLITUDE * cos(theta));
+        }
+
+#if defined(_M_IX86) || defined(_M_X64)
+        if (m_UseSse2)
+        {
+            GenerateBlockSse2(Buffer, blockFrames, sinLanes, cosLanes);
+        }
+        else
+#endif
+        {
+            GenerateBlockScalar(Buffer, blockFrames, sinLanes, cosLanes);
+        }
+
+        m_Theta += (double)blockFrames * m_SampleIncrement;
+        while (m_Theta >= TWO_PI)
+        {
+            m_Theta -= TWO_PI;
+        }
+
+        Buffer += blockFrames * m_FrameSize;
+        Frames -= blockFrames;
+    }
+
+    for (size_t i = 0; i < Frames; ++i)
+    {
+        InitNewFrame(Buffer, m_FrameSize);
+        Buffer += m_FrameSize;
     }
 }
+
+VOID ToneGenerator::GenerateBlockScalar
+(
+    _Out_writes_bytes_(Frames * m_FrameSize) BYTE*  Buffer,
+    _In_                                     size_t Frames,
+    _In_reads_(TONE_LANES)                   const float* Sin,
+    _In_reads_(TONE_LANES)                   const float* Cos
+)
+{
+    float   s[TONE_LANES];
+    float   c[TONE_LANES];
+    float   rotatedSin;
+
+    RtlCopyMemory(s, Sin, sizeof(s));
+    RtlCopyMemory(c, Cos, sizeof(c));
+
+    for (size_t frame = 0; frame < Frames; frame += TONE_LANES)
+    {
+        for (ULONG i = 0; i < TONE_LANES; ++i)
+        {
+            WriteFrame(Buffer, s[i]);
+            Buffer += m_FrameSize;
+
+            rotatedSin = s[i] * m_RotationCos + c[i] * m_RotationSin;
+            c[i] = c[i] * m_RotationCos - s[i] * m_RotationSin;
+            s[i] = rotatedSin;
+        }
+    }
+}
+
+#if defined(_M_IX86) || defined(_M_X64)
+//
+// SSE2 version of GenerateBlockScalar. The conversions truncate like
+// ConvertToShort and ConvertToUChar; mono and stereo frames are stored
+// directly, other layouts go through a staging array.
+//
+VOID ToneGenerator::GenerateBlockSse2
+(
+    _Out_writes_bytes_(Frames * m_FrameSize) BYTE*  Buffer,
+    _In_                                     size_t Frames,
+    _In_reads_(TONE_LANES)                   const float* Sin,
+    _In_reads_(TONE_LANES)                   const float* Cos
+)
+{
+    const __m128    rotationCos = _mm_set1_ps(m_RotationCos);
+    const __m128    rotationSin = _mm_set1_ps(m_RotationSin);
+    const __m128    scale16     = _mm_set1_ps((float)_I16_MAX);
+    const __m128    scale8      = _mm_set1_ps(127.5f);
+    __m128          s           = _mm_loadu_ps(Sin);
+    __m128          c           = _mm_loadu_ps(Cos);
+    __m128          rotatedSin;
+    __m128i         samples;
+    DWORD           groupSize   = TONE_LANES * m_FrameSize;
+
+    for (size_t frame = 0; frame < Frames; frame += TONE_LANES)
+    {
+        if (m_BitsPerSample == 16)
+        {
+            samples = _mm_cvttps_epi32(_mm_mul_ps(s, scale16));
+            samples = _mm_packs_epi32(samples, samples);
+
+            if (m_ChannelCount == 1)
+            {
+                _mm_storel_epi64(reinterpret_cast<__m128i *>(Buffer), samples);
+            }
+            else if (m_ChannelCount == 2)
+            {
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(Buffer), _mm_unpacklo_epi16(samples, samples));
+            }
+            else
+            {
+                short staging[8];
+
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(staging), samples);
+                for (ULONG i = 0; i < TONE_LANES; ++i)
+                {
+                    short *dataBuffer = reinterpret_cast<short *>(Buffer + i * m_FrameSize);
+                    for (ULONG channel = 0; channel < m_ChannelCount; ++channel)
+                    {
+                        dataBuffer[channel] = staging[i];
+                    }
+                }
+            }
+        }
+        else // 8 bits per sample
+        {
+            samples = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(s, scale8), scale8));
+            samples = _mm_packs_epi32(samples, samples);
+            samples = _mm_packus_epi16(samples, samples);
+
+            if (m_ChannelCount == 1)
+            {
+                *reinterpret_cast<UNALIGNED LONG *>(Buffer) = _mm_cvtsi128_si32(samples);
+            }
+            else if (m_ChannelCount == 2)
+            {
+                _mm_storel_epi64(reinterpret_cast<__m128i *>(Buffer), _mm_unpacklo_epi8(samples, samples));
+            }
+            else
+            {
+                unsigned char staging[16];
+
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(staging), samples);
+                for (ULONG i = 0; i < TONE_LANES; ++i)
+                {
+                    unsigned char *dataBuffer = Buffer + i * m_FrameSize;
+                    for (ULONG channel = 0; channel < m_ChannelCount; ++channel)
+                    {
+                        dataBuffer[channel] = staging[i];
+                    }
+                }
+            }
+        }
+
+        rotatedSin = _mm_add_ps(_mm_mul_ps(s, rotationCos), _mm_mul_ps(c, rotationSin));
+        c = _mm_sub_ps(_mm_mul_ps(c, rotationCos), _mm_mul_ps(s, rotationSin));
+        s = rotatedSin;
+
+        Buffer += groupSize;
+    }
+}
+#endif // _M_IX86 || _M_X64
 #pragma warning(pop)
 
 //
@@ -169,12 +373,9 @@ void ToneGenerator::GenerateSine
 
     size_t frames = length/m_FrameSize;
 
-    for (size_t i = 0; i < frames; ++i)
-    {
-        InitNewFrame(buffer, m_FrameSize);
-        buffer += m_FrameSize;
-        length -= m_FrameSize;
-    }
+    GenerateFrames(buffer, frames);
+    buffer += frames * m_FrameSize;
+    length -= frames * m_FrameSize;
 
     IF_TRUE_JUMP(length == 0, Done);
     
@@ -234,8 +435,21 @@ NTSTATUS ToneGenerator::Init
     m_SamplesPerSecond  = WfExt->Format.nSamplesPerSec; // samples per sec.
     m_Mute              = false;
     m_SampleIncrement   = (m_Frequency * TWO_PI) / (double)m_SamplesPerSecond;
+    m_RotationCos       = (float)cos(TONE_LANES * m_SampleIncrement);
+    m_RotationSin       = (float)sin(TONE_LANES * m_SampleIncrement);
     m_FrameSize         = (DWORD)m_ChannelCount * m_BitsPerSample/8;
     ASSERT(m_FrameSize == WfExt->Format.nBlockAlign);
+
+    //
+    // SSE2 is part of the x64 baseline; on x86 check for it.
+    //
+#if defined(_M_X64)
+    m_UseSse2           = true;
+#elif defined(_M_IX86)
+    m_UseSse2           = ExIsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE) != FALSE;
+#else
+    m_UseSse2           = false;
+#endif
     
     //
     // Restore floating state.
@@ -19,6 +19,15 @@ Abstract:
 #include <math.h>
 #include <limits.h>
 
+//
+// Samples are synthesized in groups of TONE_LANES consecutive frames. Within
+// a block of TONE_BLOCK_FRAMES frames each lane is advanced with a rotation
+// instead of a call to sin(); the lanes are seeded again from the exact
+// phase at the start of every block so rounding errors don't accumulate.
+//
+#define TONE_LANES          4
+#define TONE_BLOCK_FRAMES   256
+
 class ToneGenerator
 {
 public:
@@ -28,6 +37,9 @@ public:
     DWORD           m_SamplesPerSecond;
     double          m_Theta;
     double          m_SampleIncrement;  
+    float           m_RotationCos;
+    float           m_RotationSin;
+    bool            m_UseSse2;
     bool            m_Mute;
     BYTE*           m_PartialFrame;
     DWORD           m_PartialFrameBytes;
@@ -66,6 +78,36 @@ private:
         _Out_writes_bytes_(FrameSize)   BYTE*  Frame, 
         _In_                            DWORD  FrameSize
     );
+
+    VOID WriteFrame
+    (
+        _Out_writes_bytes_(m_FrameSize) BYTE*  Frame,
+        _In_                            double Value
+    );
+
+    VOID GenerateFrames
+    (
+        _Out_writes_bytes_(Frames * m_FrameSize) BYTE*  Buffer,
+        _In_                                     size_t Frames
+    );
+
+    VOID GenerateBlockScalar
+    (
+        _Out_writes_bytes_(Frames * m_FrameSize) BYTE*  Buffer,
+        _In_                                     size_t Frames,
+        _In_reads_(TONE_LANES)                   const float* Sin,
+        _In_reads_(TONE_LANES)                   const float* Cos
+    );
+
+#if defined(_M_IX86) || defined(_M_X64)
+    VOID GenerateBlockSse2
+    (
+        _Out_writes_bytes_(Frames * m_FrameSize) BYTE*  Buffer,
+        _In_                                     size_t Frames,
+        _In_reads_(TONE_LANES)                   const float* Sin,
+        _In_reads_(TONE_LANES)                   const float* Cos
+    );
+#endif
 };
 
 #endif // _SYSVAD_TONEGENERATOR_H
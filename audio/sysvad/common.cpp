@@ -38,8 +38,13 @@ Abstract:
 // CSaveData statics
 //-----------------------------------------------------------------------------
 
-PSAVEWORKER_PARAM       CSaveData::m_pWorkItems = NULL;
 PDEVICE_OBJECT          CSaveData::m_pDeviceObject = NULL;
+PKTHREAD                CSaveData::m_pWriterThread = NULL;
+KEVENT                  CSaveData::m_WriterEvent;
+KMUTEX                  CSaveData::m_WriterLock;
+LIST_ENTRY              CSaveData::m_WriterList;
+volatile BOOL           CSaveData::m_bWriterStop = FALSE;
+SYSVAD_SAVEDATA_STATISTICS CSaveData::m_TotalStatistics = { 0 };
 
 //=============================================================================
 // Classes
@@ -898,7 +903,7 @@ Return Value:
         m_pHW = NULL;
     }
     
-    CSaveData::DestroyWorkItems();
+    CSaveData::DestroyWriter();
 
     SAFE_RELEASE(m_pPortClsEtwHelper);
     SAFE_RELEASE(m_pServiceGroupWave);
@@ -1078,8 +1083,8 @@ Return Value:
     //
     // Initialize SaveData class.
     //
-    CSaveData::SetDeviceObject(DeviceObject);   //device object is needed by CSaveData
-    ntStatus = CSaveData::InitializeWorkItems(DeviceObject);
+    CSaveData::SetDeviceObject(DeviceObject);
+    ntStatus = CSaveData::InitializeWriter();
     IF_FAILED_JUMP(ntStatus, Done);
 
 Done:
@@ -16,6 +16,7 @@ Abstract:
 #define _SYSVAD_COMMON_H_
 
 #define HNSTIME_PER_MILLISECOND 10000
+#define HNSTIME_PER_SECOND      (1000 * HNSTIME_PER_MILLISECOND)
 
 //=============================================================================
 // Macros
@@ -10,11 +10,17 @@ Abstract:
 
     Implementation of SYSVAD data saving class.
 
-    To save the playback data to disk, this class maintains a circular data
-    buffer, associated frame structures and worker items to save frames to
-    disk.
-    Each frame structure represents a portion of buffer. When that portion
-    of frame is full, a workitem is scheduled to save it to disk.
+    To save the playback data to disk, each stream copies its data into a
+    ring buffer and one writer thread saves the rings of all the streams.
+    The stream is the only producer of its ring and the writer thread the
+    only consumer, so the ring is lock free: each side owns one counter and
+    publishes it with release semantics after touching the data.
+
+    The writer thread keeps the data files open and is woken when a ring is
+    a quarter full or when SAVEDATA_WRITER_PERIOD_MS elapse, whichever comes
+    first; it saves everything the rings hold, up to SAVEDATA_MAX_WRITE_SIZE
+    bytes per ZwWriteFile. If a ring has no room for a write, the write is
+    dropped and counted, see KSPROPERTY_SYSVAD_SAVEDATA_STATISTICS.
 
 
 
@@ -43,16 +49,18 @@ Abstract:
 #define FMT__TAG                    0x20746D66;
 #define DATA_TAG                    0x61746164;
 
-#define DEFAULT_FRAME_COUNT         2
-#define DEFAULT_FRAME_SIZE          PAGE_SIZE * 4 
-#define DEFAULT_BUFFER_SIZE         DEFAULT_FRAME_SIZE * DEFAULT_FRAME_COUNT
+// The ring holds SAVEDATA_BUFFER_WRITES of the largest writes of the stream,
+// and never less than SAVEDATA_MIN_BUFFER_SIZE. Both sizes are powers of 2.
+#define SAVEDATA_MIN_BUFFER_SIZE    (512 * 1024)
+#define SAVEDATA_BUFFER_WRITES      4
+
+#define SAVEDATA_MAX_WRITE_SIZE     (1024 * 1024)
+#define SAVEDATA_WRITER_PERIOD_MS   20
 
 #define DEFAULT_FILE_NAME           L"\\DosDevices\\C:\\STREAM"
 #define OFFLOAD_FILE_NAME           L"OFFLOAD"
 #define HOST_FILE_NAME              L"HOST"
 
-#define MAX_WORKER_ITEM_COUNT       15
-
 //=============================================================================
 // Statics
 //=============================================================================
@@ -66,16 +74,14 @@ ULONG CSaveData::m_ulOffloadStreamId = 0;
 
 //=============================================================================
 CSaveData::CSaveData()
-:   m_pDataBuffer(NULL),
-    m_FileHandle(NULL),
-    m_ulFrameCount(DEFAULT_FRAME_COUNT),
-    m_ulBufferSize(DEFAULT_BUFFER_SIZE),
-    m_ulFrameSize(DEFAULT_FRAME_SIZE),
-    m_ulBufferOffset(0),
-    m_ulFrameIndex(0),
-    m_fFrameUsed(NULL),
+:   m_FileHandle(NULL),
+    m_pDataBuffer(NULL),
+    m_ulBufferSize(SAVEDATA_MIN_BUFFER_SIZE),
+    m_ulWakeThreshold(SAVEDATA_MIN_BUFFER_SIZE / 4),
+    m_ulWriteCount(0),
+    m_ulReadCount(0),
+    m_bWriterListed(FALSE),
     m_waveFormat(NULL),
-    m_pFilePtr(NULL),
     m_fWriteDisabled(FALSE),
     m_bInitialized(FALSE)
 {
@@ -90,7 +96,11 @@ CSaveData::CSaveData()
     m_DataHeader.dwData           = DATA_TAG;
     m_DataHeader.dwDataLength     = 0;
 
+    m_FilePtr.QuadPart = 0;
+
+    RtlZeroMemory(&m_FileName, sizeof(m_FileName));
     RtlZeroMemory(&m_objectAttributes, sizeof(m_objectAttributes));
+    RtlZeroMemory(&m_Statistics, sizeof(m_Statistics));
 } // CSaveData
 
 //=============================================================================
@@ -100,35 +110,43 @@ CSaveData::~CSaveData()
 
     DPF_ENTER(("[CSaveData::~CSaveData]"));
 
-    // Update the wave header in data file with real file size.
+    // Take the stream off the writer, save what is left in the ring and
+    // update the wave header in data file with real file size.
     //
-    if(m_pFilePtr)
+    if (m_bWriterListed)
     {
+        KeWaitForSingleObject
+        (
+            &m_WriterLock,
+            Executive,
+            KernelMode,
+            FALSE,
+            NULL
+        );
+
+        RemoveEntryList(&m_WriterListEntry);
+        m_bWriterListed = FALSE;
+
+        DrainBuffer();
+
         m_FileHeader.dwFileSize =
-            (DWORD) m_pFilePtr->QuadPart - 2 * sizeof(DWORD);
-        m_DataHeader.dwDataLength = (DWORD) m_pFilePtr->QuadPart -
+            (DWORD) m_FilePtr.QuadPart - 2 * sizeof(DWORD);
+        m_DataHeader.dwDataLength = (DWORD) m_FilePtr.QuadPart -
                                      sizeof(m_FileHeader)        -
                                      m_FileHeader.dwFormatLength -
                                      sizeof(m_DataHeader);
 
-        if (STATUS_SUCCESS == KeWaitForSingleObject
-            (
-                &m_FileSync,
-                Executive,
-                KernelMode,
-                FALSE,
-                NULL
-            ))
-        {
-            if (NT_SUCCESS(FileOpen(FALSE)))
-            {
-                FileWriteHeader();
+        FileWriteHeader();
 
-                FileClose();
-            }
+        FileClose();
 
-            KeReleaseMutex(&m_FileSync, FALSE);
-        }
+        KeReleaseMutex(&m_WriterLock, FALSE);
+
+        DPF(D_VERBOSE, ("[CSaveData::~CSaveData] %I64u bytes in %lu writes, %lu overruns, %I64u bytes dropped",
+            m_Statistics.BytesWritten,
+            m_Statistics.FileWrites,
+            m_Statistics.Overruns,
+            m_Statistics.BytesDropped));
     }
 
     if (m_waveFormat)
@@ -137,13 +155,6 @@ CSaveData::~CSaveData()
         m_waveFormat = NULL;
     }
 
-    if (m_fFrameUsed)
-    {
-        ExFreePoolWithTag(m_fFrameUsed, SAVEDATA_POOLTAG2);
-        m_fFrameUsed = NULL;
-        // NOTE : Do not release m_pFilePtr.
-    }
-
     if (m_FileName.Buffer)
     {
         ExFreePoolWithTag(m_FileName.Buffer, SAVEDATA_POOLTAG3);
@@ -159,28 +170,34 @@ CSaveData::~CSaveData()
 
 //=============================================================================
 void
-CSaveData::DestroyWorkItems
+CSaveData::DestroyWriter
 (
     void
 )
 {
     PAGED_CODE();
 
-    if (m_pWorkItems)
+    DPF_ENTER(("[CSaveData::DestroyWriter]"));
+
+    if (m_pWriterThread)
     {
-        for (int i = 0; i < MAX_WORKER_ITEM_COUNT; i++)
-        {
-            if (m_pWorkItems[i].WorkItem!=NULL)
-            {
-                IoFreeWorkItem(m_pWorkItems[i].WorkItem);
-                m_pWorkItems[i].WorkItem = NULL;
-            }
-        }
-        ExFreePoolWithTag(m_pWorkItems, SAVEDATA_POOLTAG);
-        m_pWorkItems = NULL;
+        m_bWriterStop = TRUE;
+        KeSetEvent(&m_WriterEvent, IO_NO_INCREMENT, FALSE);
+
+        KeWaitForSingleObject
+        (
+            m_pWriterThread,
+            Executive,
+            KernelMode,
+            FALSE,
+            NULL
+        );
+
+        ObDereferenceObject(m_pWriterThread);
+        m_pWriterThread = NULL;
     }
 
-} // DestroyWorkItems
+} // DestroyWriter
 
 //=============================================================================
 void
@@ -194,6 +211,53 @@ CSaveData::Disable
     m_fWriteDisabled = fDisable;
 } // Disable
 
+//=============================================================================
+void
+CSaveData::DrainBuffer
+(
+    void
+)
+/*++
+
+Routine Description:
+
+  Saves all the data the ring holds. Called by the writer thread, or by
+  the stream when it needs the data on disk, with m_WriterLock held.
+
+--*/
+{
+    PAGED_CODE();
+
+    ULONG                       ulReadCount = m_ulReadCount;
+    ULONG                       ulWriteCount;
+    ULONG                       ulOffset;
+    ULONG                       ulBytes;
+
+    // Pairs with the release in WriteData: the data is read only after the
+    // count that covers it.
+    //
+    ulWriteCount = (ULONG) ReadAcquire((volatile LONG *) &m_ulWriteCount);
+
+    while (ulReadCount != ulWriteCount)
+    {
+        ulOffset = ulReadCount & (m_ulBufferSize - 1);
+
+        ulBytes = min(ulWriteCount - ulReadCount, m_ulBufferSize - ulOffset);
+        ulBytes = min(ulBytes, SAVEDATA_MAX_WRITE_SIZE);
+
+        // The data is consumed even if the write fails, so a file error
+        // does not stop the stream with a full ring.
+        //
+        FileWrite(m_pDataBuffer + ulOffset, ulBytes);
+
+        ulReadCount += ulBytes;
+
+        // Hand the space back to WriteData only after it is saved.
+        //
+        WriteRelease((volatile LONG *) &m_ulReadCount, (LONG) ulReadCount);
+    }
+} // DrainBuffer
+
 //=============================================================================
 NTSTATUS
 CSaveData::FileClose(void)
@@ -265,7 +329,6 @@ CSaveData::FileWrite
     PAGED_CODE();
 
     ASSERT(pData);
-    ASSERT(m_pFilePtr);
 
     NTSTATUS                    ntStatus;
 
@@ -280,14 +343,20 @@ CSaveData::FileWrite
                                 &ioStatusBlock,
                                 pData,
                                 ulDataSize,
-                                m_pFilePtr,
+                                &m_FilePtr,
                                 NULL);
 
         if (NT_SUCCESS(ntStatus))
         {
             ASSERT(ioStatusBlock.Information == ulDataSize);
 
-            m_pFilePtr->QuadPart += ulDataSize;
+            m_FilePtr.QuadPart += ulDataSize;
+
+            m_Statistics.BytesWritten += ulDataSize;
+            m_Statistics.FileWrites++;
+
+            InterlockedAdd64((volatile LONG64 *) &m_TotalStatistics.BytesWritten, ulDataSize);
+            InterlockedIncrement((volatile LONG *) &m_TotalStatistics.FileWrites);
         }
         else
         {
@@ -315,7 +384,7 @@ CSaveData::FileWriteHeader(void)
     {
         IO_STATUS_BLOCK         ioStatusBlock;
 
-        m_pFilePtr->QuadPart = 0;
+        m_FilePtr.QuadPart = 0;
 
         m_FileHeader.dwFormatLength = (m_waveFormat->wFormatTag == WAVE_FORMAT_PCM) ?
                                         sizeof( PCMWAVEFORMAT ) :
@@ -328,14 +397,14 @@ CSaveData::FileWriteHeader(void)
                                 &ioStatusBlock,
                                 &m_FileHeader,
                                 sizeof(m_FileHeader),
-                                m_pFilePtr,
+                                &m_FilePtr,
                                 NULL);
         if (!NT_SUCCESS(ntStatus))
         {
             DPF(D_TERSE, ("[CSaveData::FileWriteHeader : Write File Header Error]"));
         }
 
-        m_pFilePtr->QuadPart += sizeof(m_FileHeader);
+        m_FilePtr.QuadPart += sizeof(m_FileHeader);
 
         ntStatus = ZwWriteFile( m_FileHandle,
                                 NULL,
@@ -344,14 +413,14 @@ CSaveData::FileWriteHeader(void)
                                 &ioStatusBlock,
                                 m_waveFormat,
                                 m_FileHeader.dwFormatLength,
-                                m_pFilePtr,
+                                &m_FilePtr,
                                 NULL);
         if (!NT_SUCCESS(ntStatus))
         {
             DPF(D_TERSE, ("[CSaveData::FileWriteHeader : Write Format Error]"));
         }
 
-        m_pFilePtr->QuadPart += m_FileHeader.dwFormatLength;
+        m_FilePtr.QuadPart += m_FileHeader.dwFormatLength;
 
         ntStatus = ZwWriteFile( m_FileHandle,
                                 NULL,
@@ -360,14 +429,14 @@ CSaveData::FileWriteHeader(void)
                                 &ioStatusBlock,
                                 &m_DataHeader,
                                 sizeof(m_DataHeader),
-                                m_pFilePtr,
+                                &m_FilePtr,
                                 NULL);
         if (!NT_SUCCESS(ntStatus))
         {
             DPF(D_TERSE, ("[CSaveData::FileWriteHeader : Write Data Header Error]"));
         }
 
-        m_pFilePtr->QuadPart += sizeof(m_DataHeader);
+        m_FilePtr.QuadPart += sizeof(m_DataHeader);
     }
     else
     {
@@ -377,6 +446,67 @@ CSaveData::FileWriteHeader(void)
 
     return ntStatus;
 } // FileWriteHeader
+
+//=============================================================================
+void
+CSaveData::Flush
+(
+    void
+)
+/*++
+
+Routine Description:
+
+  Saves the data buffered so far without waiting for the writer thread.
+
+--*/
+{
+    PAGED_CODE();
+
+    DPF_ENTER(("[CSaveData::Flush]"));
+
+    if (!m_bWriterListed)
+    {
+        return;
+    }
+
+    KeWaitForSingleObject
+    (
+        &m_WriterLock,
+        Executive,
+        KernelMode,
+        FALSE,
+        NULL
+    );
+
+    DrainBuffer();
+
+    KeReleaseMutex(&m_WriterLock, FALSE);
+} // Flush
+
+//=============================================================================
+void
+CSaveData::GetStatistics
+(
+    _Out_ PSYSVAD_SAVEDATA_STATISTICS   pStatistics
+)
+{
+    PAGED_CODE();
+
+    ASSERT(pStatistics);
+
+    // The 64-bit totals are read with an interlocked operation so they are
+    // not torn on x86.
+    //
+    pStatistics->BytesWritten = (ULONGLONG)
+        InterlockedCompareExchange64((volatile LONG64 *) &m_TotalStatistics.BytesWritten, 0, 0);
+    pStatistics->BytesDropped = (ULONGLONG)
+        InterlockedCompareExchange64((volatile LONG64 *) &m_TotalStatistics.BytesDropped, 0, 0);
+    pStatistics->Overruns   = (ULONG) ReadNoFence((volatile LONG *) &m_TotalStatistics.Overruns);
+    pStatistics->FileWrites = (ULONG) ReadNoFence((volatile LONG *) &m_TotalStatistics.FileWrites);
+} // GetStatistics
+
+//=============================================================================
 NTSTATUS
 CSaveData::SetDeviceObject
 (
@@ -388,7 +518,7 @@ CSaveData::SetDeviceObject
     ASSERT(DeviceObject);
 
     NTSTATUS                    ntStatus = STATUS_SUCCESS;
-    
+
     m_pDeviceObject = DeviceObject;
     return ntStatus;
 }
@@ -404,41 +534,6 @@ CSaveData::GetDeviceObject
     return m_pDeviceObject;
 }
 
-#pragma code_seg()
-//=============================================================================
-PSAVEWORKER_PARAM
-CSaveData::GetNewWorkItem
-(
-    void
-)
-{
-    LARGE_INTEGER               timeOut = { 0 };
-    NTSTATUS                    ntStatus;
-
-    for (int i = 0; i < MAX_WORKER_ITEM_COUNT; i++)
-    {
-        ntStatus =
-            KeWaitForSingleObject
-            (
-                &m_pWorkItems[i].EventDone,
-                Executive,
-                KernelMode,
-                FALSE,
-                &timeOut
-            );
-        if (STATUS_SUCCESS == ntStatus)
-        {
-            if (m_pWorkItems[i].WorkItem)
-                return &(m_pWorkItems[i]);
-            else
-                return NULL;
-        }
-    }
-
-    return NULL;
-} // GetNewWorkItem
-#pragma code_seg("PAGE")
-
 //=============================================================================
 NTSTATUS
 CSaveData::Initialize
@@ -454,6 +549,12 @@ CSaveData::Initialize
 
     DPF_ENTER(("[CSaveData::Initialize]"));
 
+    if (m_pWriterThread == NULL)
+    {
+        DPF(D_TERSE, ("[CSaveData::Initialize : Writer thread is not running]"));
+        return STATUS_INVALID_DEVICE_STATE;
+    }
+
     if (_bOffloaded)
     {
         m_ulOffloadStreamId++;
@@ -505,50 +606,17 @@ CSaveData::Initialize
             DPF(D_TERSE, ("[Could not allocate memory for Saving Data]"));
             ntStatus = STATUS_INSUFFICIENT_RESOURCES;
         }
-        else 
+        else
         {
             RtlZeroMemory(m_pDataBuffer, m_ulBufferSize);
         }
     }
 
-    // Allocate memory for frame usage flags and m_pFilePtr.
+    // Create the data file, write the wave header and hand the stream to
+    // the writer thread. The file stays open until the stream goes away.
     //
     if (NT_SUCCESS(ntStatus))
     {
-        m_fFrameUsed = (PBOOL)
-            ExAllocatePoolWithTag
-            (
-                NonPagedPoolNx,
-                m_ulFrameCount * sizeof(BOOL) +
-                sizeof(LARGE_INTEGER),
-                SAVEDATA_POOLTAG2
-            );
-        if (!m_fFrameUsed)
-        {
-            DPF(D_TERSE, ("[Could not allocate memory for frame flags]"));
-            ntStatus = STATUS_INSUFFICIENT_RESOURCES;
-        }
-    }
-
-    // Initialize the spinlock to synchronize access to the frames
-    //
-    KeInitializeSpinLock ( &m_FrameInUseSpinLock ) ;
-
-    // Initialize the file mutex
-    //
-    KeInitializeMutex( &m_FileSync, 1 ) ;
-
-    // Open the data file.
-    //
-    if (NT_SUCCESS(ntStatus))
-    {
-        // m_fFrameUsed has additional memory to hold m_pFilePtr
-        //
-        m_pFilePtr = (PLARGE_INTEGER)
-            (((PBYTE) m_fFrameUsed) + m_ulFrameCount * sizeof(BOOL));
-        RtlZeroMemory(m_fFrameUsed, m_ulFrameCount * sizeof(BOOL) + sizeof(LARGE_INTEGER));
-
-        // Create data file.
         InitializeObjectAttributes
         (
             &m_objectAttributes,
@@ -563,7 +631,7 @@ CSaveData::Initialize
         // Write wave header information to data file.
         ntStatus = KeWaitForSingleObject
             (
-                &m_FileSync,
+                &m_WriterLock,
                 Executive,
                 KernelMode,
                 FALSE,
@@ -576,11 +644,19 @@ CSaveData::Initialize
             if (NT_SUCCESS(ntStatus))
             {
                 ntStatus = FileWriteHeader();
+            }
 
+            if (NT_SUCCESS(ntStatus))
+            {
+                InsertTailList(&m_WriterList, &m_WriterListEntry);
+                m_bWriterListed = TRUE;
+            }
+            else
+            {
                 FileClose();
             }
 
-            KeReleaseMutex( &m_FileSync, FALSE );
+            KeReleaseMutex( &m_WriterLock, FALSE );
         }
     }
 
@@ -589,116 +665,186 @@ CSaveData::Initialize
 
 //=============================================================================
 NTSTATUS
-CSaveData::InitializeWorkItems
+CSaveData::InitializeWriter
 (
-    _In_  PDEVICE_OBJECT        DeviceObject
+    void
 )
 {
     PAGED_CODE();
 
-    ASSERT(DeviceObject);
-
     NTSTATUS                    ntStatus = STATUS_SUCCESS;
+    OBJECT_ATTRIBUTES           objectAttributes;
+    HANDLE                      hThread = NULL;
 
-    DPF_ENTER(("[CSaveData::InitializeWorkItems]"));
+    DPF_ENTER(("[CSaveData::InitializeWriter]"));
 
-    if (m_pWorkItems != NULL)
+    if (m_pWriterThread != NULL)
     {
         return ntStatus;
     }
 
-    m_pWorkItems = (PSAVEWORKER_PARAM)
-        ExAllocatePoolWithTag
+    KeInitializeEvent(&m_WriterEvent, SynchronizationEvent, FALSE);
+    KeInitializeMutex(&m_WriterLock, 1);
+    InitializeListHead(&m_WriterList);
+    m_bWriterStop = FALSE;
+
+    InitializeObjectAttributes(&objectAttributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
+
+    ntStatus = PsCreateSystemThread
         (
-            NonPagedPoolNx,
-            sizeof(SAVEWORKER_PARAM) * MAX_WORKER_ITEM_COUNT,
-            SAVEDATA_POOLTAG
+            &hThread,
+            THREAD_ALL_ACCESS,
+            &objectAttributes,
+            NULL,
+            NULL,
+            SaveDataWriterThread,
+            NULL
         );
-    if (m_pWorkItems)
+    if (!NT_SUCCESS(ntStatus))
     {
-        for (int i = 0; i < MAX_WORKER_ITEM_COUNT; i++)
-        {
+        DPF(D_TERSE, ("[CSaveData::InitializeWriter : Could not create writer thread, 0x%x]", ntStatus));
+        return ntStatus;
+    }
 
-            m_pWorkItems[i].WorkItem = IoAllocateWorkItem(DeviceObject);
-            if(m_pWorkItems[i].WorkItem == NULL)
-            {
-              return STATUS_INSUFFICIENT_RESOURCES;
-            }
-            KeInitializeEvent
-            (
-                &m_pWorkItems[i].EventDone,
-                NotificationEvent,
-                TRUE
-            );
+    ntStatus = ObReferenceObjectByHandle
+        (
+            hThread,
+            THREAD_ALL_ACCESS,
+            *PsThreadType,
+            KernelMode,
+            (PVOID *) &m_pWriterThread,
+            NULL
+        );
+
+    ZwClose(hThread);
+
+    if (!NT_SUCCESS(ntStatus))
+    {
+        // Without a reference the thread cannot be waited for; let it exit
+        // on its own.
+        //
+        m_pWriterThread = NULL;
+        m_bWriterStop = TRUE;
+        KeSetEvent(&m_WriterEvent, IO_NO_INCREMENT, FALSE);
+    }
+
+    return ntStatus;
+} // InitializeWriter
+
+//=============================================================================
+NTSTATUS
+CSaveData::PropertyHandlerStatistics
+(
+    _In_  PPCPROPERTY_REQUEST   PropertyRequest
+)
+/*++
+
+Routine Description:
+
+  Processes KSPROPERTY_SYSVAD_SAVEDATA_STATISTICS
+
+Arguments:
+
+  PropertyRequest - property request structure.
+
+Return Value:
+
+  NT status code.
+
+--*/
+{
+    PAGED_CODE();
+
+    DPF_ENTER(("[CSaveData::PropertyHandlerStatistics]"));
+
+    NTSTATUS ntStatus = STATUS_INVALID_DEVICE_REQUEST;
+
+    if (PropertyRequest->Verb & KSPROPERTY_TYPE_GET)
+    {
+        ntStatus = ValidatePropertyParams(PropertyRequest, sizeof(SYSVAD_SAVEDATA_STATISTICS));
+        if (NT_SUCCESS(ntStatus))
+        {
+            GetStatistics((PSYSVAD_SAVEDATA_STATISTICS) PropertyRequest->Value);
+            PropertyRequest->ValueSize = sizeof(SYSVAD_SAVEDATA_STATISTICS);
         }
     }
-    else
+    else if (PropertyRequest->Verb & KSPROPERTY_TYPE_BASICSUPPORT)
     {
-        ntStatus = STATUS_INSUFFICIENT_RESOURCES;
+        ntStatus =
+            PropertyHandler_BasicSupport
+            (
+                PropertyRequest,
+                KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
+                VT_ILLEGAL
+            );
     }
 
     return ntStatus;
-} // InitializeWorkItems
+} // PropertyHandlerStatistics
 
 //=============================================================================
 
-IO_WORKITEM_ROUTINE SaveFrameWorkerCallback;
+KSTART_ROUTINE SaveDataWriterThread;
 
 VOID
-SaveFrameWorkerCallback
+SaveDataWriterThread
 (
-    _In_        PDEVICE_OBJECT         pDeviceObject, 
-    _In_opt_    PVOID                  Context
+    _In_        PVOID                  Context
 )
 {
-    UNREFERENCED_PARAMETER(pDeviceObject);
+    UNREFERENCED_PARAMETER(Context);
 
     PAGED_CODE();
 
-    ASSERT(Context);
+    LARGE_INTEGER               timeOut;
+    PLIST_ENTRY                 pEntry;
+    BOOL                        fStop = FALSE;
 
-    PSAVEWORKER_PARAM           pParam = (PSAVEWORKER_PARAM) Context;
-    PCSaveData                  pSaveData;
-    
-    if (NULL == pParam)
-    {
-        // This is completely unexpected, assert here.
-        //
-        ASSERT(pParam);
-        return;
-    }
+    DPF_ENTER(("[SaveDataWriterThread]"));
 
-    DPF(D_VERBOSE, ("[SaveFrameWorkerCallback], %d", pParam->ulFrameNo));
+    // Run above the system worker threads, so saving audio data does not
+    // wait behind ordinary work.
+    //
+    KeSetPriorityThread(KeGetCurrentThread(), LOW_REALTIME_PRIORITY);
 
-    ASSERT(pParam->pSaveData);
-    ASSERT(pParam->pSaveData->m_fFrameUsed);
+    timeOut.QuadPart = -((LONGLONG) SAVEDATA_WRITER_PERIOD_MS * HNSTIME_PER_MILLISECOND);
 
-    if (pParam->WorkItem)
+    while (!fStop)
     {
-        pSaveData = pParam->pSaveData;
+        KeWaitForSingleObject
+        (
+            &CSaveData::m_WriterEvent,
+            Executive,
+            KernelMode,
+            FALSE,
+            &timeOut
+        );
 
-        if (STATUS_SUCCESS == KeWaitForSingleObject
-            (
-                &pSaveData->m_FileSync,
-                Executive,
-                KernelMode,
-                FALSE,
-                NULL
-            ))
-        {
-            if (NT_SUCCESS(pSaveData->FileOpen(FALSE)))
-            { 
-                pSaveData->FileWrite(pParam->pData, pParam->ulDataSize);
-                pSaveData->FileClose();
-            }
-            InterlockedExchange( (LONG *)&(pSaveData->m_fFrameUsed[pParam->ulFrameNo]), FALSE );
+        // Save the rings once more after the stop request, then exit.
+        //
+        fStop = CSaveData::m_bWriterStop;
+
+        KeWaitForSingleObject
+        (
+            &CSaveData::m_WriterLock,
+            Executive,
+            KernelMode,
+            FALSE,
+            NULL
+        );
 
-            KeReleaseMutex( &pSaveData->m_FileSync, FALSE );
+        for (pEntry = CSaveData::m_WriterList.Flink;
+             pEntry != &CSaveData::m_WriterList;
+             pEntry = pEntry->Flink)
+        {
+            CONTAINING_RECORD(pEntry, CSaveData, m_WriterListEntry)->DrainBuffer();
         }
+
+        KeReleaseMutex(&CSaveData::m_WriterLock, FALSE);
     }
 
-    KeSetEvent(&pParam->EventDone, 0, FALSE);
-} // SaveFrameWorkerCallback
+    PsTerminateSystemThread(STATUS_SUCCESS);
+} // SaveDataWriterThread
 
 //=============================================================================
 NTSTATUS
@@ -709,7 +855,7 @@ CSaveData::SetDataFormat
 {
     PAGED_CODE();
     NTSTATUS                    ntStatus = STATUS_SUCCESS;
- 
+
     DPF_ENTER(("[CSaveData::SetDataFormat]"));
 
     ASSERT(pDataFormat);
@@ -770,17 +916,23 @@ CSaveData::SetMaxWriteSize
 )
 {
     PAGED_CODE();
-    
+
     NTSTATUS    ntStatus    = STATUS_SUCCESS;
-    ULONG       bufferSize  = 0;
+    ULONG       minSize     = 0;
+    ULONG       bufferSize  = SAVEDATA_MIN_BUFFER_SIZE;
     PBYTE       buffer      = NULL;
- 
+
     DPF_ENTER(("[CSaveData::SetMaxWriteSize]"));
 
-    // 
-    // Compute new buffer size.
     //
-    ntStatus = RtlULongMult(ulMaxWriteSize, DEFAULT_FRAME_COUNT, &bufferSize);
+    // Compute new buffer size, rounded up to a power of 2 so the ring
+    // offsets are a mask of the counts.
+    //
+    ntStatus = RtlULongMult(ulMaxWriteSize, SAVEDATA_BUFFER_WRITES, &minSize);
+    while (NT_SUCCESS(ntStatus) && bufferSize < minSize)
+    {
+        ntStatus = RtlULongMult(bufferSize, 2, &bufferSize);
+    }
     if (!NT_SUCCESS(ntStatus))
     {
         DPF(D_TERSE, ("[Could not allocate memory for Saving Data, MaxWriteSize %u is too big]", ulMaxWriteSize));
@@ -807,6 +959,24 @@ CSaveData::SetMaxWriteSize
 
     RtlZeroMemory(buffer, bufferSize);
 
+    //
+    // Save the data still in the old ring and keep the writer off it while
+    // it is replaced. The stream is not running, so WriteData is not called.
+    //
+    if (m_bWriterListed)
+    {
+        KeWaitForSingleObject
+        (
+            &m_WriterLock,
+            Executive,
+            KernelMode,
+            FALSE,
+            NULL
+        );
+
+        DrainBuffer();
+    }
+
     //
     // Free old one.
     //
@@ -819,15 +989,22 @@ CSaveData::SetMaxWriteSize
     //
     // Init new buffer settings.
     //
-    m_pDataBuffer  = buffer;
-    m_ulBufferSize = bufferSize;
-    m_ulFrameSize  = ulMaxWriteSize;
-    
+    m_pDataBuffer     = buffer;
+    m_ulBufferSize    = bufferSize;
+    m_ulWakeThreshold = min(bufferSize / 4, SAVEDATA_MAX_WRITE_SIZE);
+    m_ulWriteCount    = 0;
+    m_ulReadCount     = 0;
+
+    if (m_bWriterListed)
+    {
+        KeReleaseMutex(&m_WriterLock, FALSE);
+    }
+
     ntStatus = STATUS_SUCCESS;
 
 Done:
     return ntStatus;
-} // SetDataFormat
+} // SetMaxWriteSize
 
 //=============================================================================
 void
@@ -845,66 +1022,6 @@ CSaveData::ReadData
     // Not implemented yet.
 } // ReadData
 
-//=============================================================================
-#pragma code_seg()
-void
-CSaveData::SaveFrame
-(
-    _In_ ULONG                  ulFrameNo,
-    _In_ ULONG                  ulDataSize
-)
-{
-    PSAVEWORKER_PARAM           pParam = NULL;
-
-    DPF_ENTER(("[CSaveData::SaveFrame]"));
-
-    pParam = GetNewWorkItem();
-    if (pParam)
-    {
-        pParam->pSaveData = this;
-        pParam->ulFrameNo = ulFrameNo;
-        pParam->ulDataSize = ulDataSize;
-        pParam->pData = m_pDataBuffer + ulFrameNo * m_ulFrameSize;
-        KeResetEvent(&pParam->EventDone);
-        IoQueueWorkItem(pParam->WorkItem, SaveFrameWorkerCallback,
-                        CriticalWorkQueue, (PVOID)pParam);
-    }
-} // SaveFrame
-#pragma code_seg("PAGE")
-//=============================================================================
-void
-CSaveData::WaitAllWorkItems
-(
-    void
-)
-{
-    PAGED_CODE();
-
-    DPF_ENTER(("[CSaveData::WaitAllWorkItems]"));
-
-    // Save the last partially-filled frame
-    if (m_ulBufferOffset > m_ulFrameIndex * m_ulFrameSize)
-    {
-        ULONG size;
-        
-        size = m_ulBufferOffset - m_ulFrameIndex * m_ulFrameSize;
-        SaveFrame(m_ulFrameIndex, size);
-    }
-    
-    for (int i = 0; i < MAX_WORKER_ITEM_COUNT; i++)
-    {
-        DPF(D_VERBOSE, ("[Waiting for WorkItem] %d", i));
-        KeWaitForSingleObject
-        (
-            &(m_pWorkItems[i].EventDone),
-            Executive,
-            KernelMode,
-            FALSE,
-            NULL
-        );
-    }
-} // WaitAllWorkItems
-
 #pragma code_seg()
 //=============================================================================
 void
@@ -916,9 +1033,10 @@ CSaveData::WriteData
 {
     ASSERT(pBuffer);
 
-    BOOL                        fSaveFrame = FALSE;
-    ULONG                       ulSaveFrameIndex = 0;
-    KIRQL                       oldIrql;
+    ULONG                       ulWriteCount;
+    ULONG                       ulReadCount;
+    ULONG                       ulOffset;
+    ULONG                       ulFirstBytes;
 
     // If stream writing is disabled, then exit.
     //
@@ -934,82 +1052,49 @@ CSaveData::WriteData
         return;
     }
 
-    // The logic below assumes that write size is <= than frame size.
-    if (ulByteCount > m_ulFrameSize)
-    {
-        ulByteCount = m_ulFrameSize;
-    }
-        
-    // Check to see if this frame is available.
-    KeAcquireSpinLock(&m_FrameInUseSpinLock, &oldIrql);
-    if (!m_fFrameUsed[m_ulFrameIndex])
-    {
-        KeReleaseSpinLock(&m_FrameInUseSpinLock, oldIrql );
+    ulWriteCount = m_ulWriteCount;
 
-        ULONG ulWriteBytes = ulByteCount;
+    // Pairs with the release in DrainBuffer: the space is reused only after
+    // the writer is done with it.
+    //
+    ulReadCount = (ULONG) ReadAcquire((volatile LONG *) &m_ulReadCount);
 
-        if( (m_ulBufferSize - m_ulBufferOffset) < ulWriteBytes )
-        {
-            ulWriteBytes = m_ulBufferSize - m_ulBufferOffset;
-        }
+    // If the writer is behind, drop the whole write rather than a part of
+    // it, and make sure the writer is on its way.
+    //
+    if (ulByteCount > m_ulBufferSize - (ulWriteCount - ulReadCount))
+    {
+        m_Statistics.Overruns++;
+        m_Statistics.BytesDropped += ulByteCount;
 
-        RtlCopyMemory(m_pDataBuffer + m_ulBufferOffset, pBuffer, ulWriteBytes);
-        m_ulBufferOffset += ulWriteBytes;
+        InterlockedIncrement((volatile LONG *) &m_TotalStatistics.Overruns);
+        InterlockedAdd64((volatile LONG64 *) &m_TotalStatistics.BytesDropped, ulByteCount);
 
-        // Check to see if we need to save this frame
-        if (m_ulBufferOffset >= ((m_ulFrameIndex + 1) * m_ulFrameSize))
-        {
-            fSaveFrame = TRUE;
-        }
+        DPF(D_BLAB, ("[Buffer overrun, %lu bytes dropped]", ulByteCount));
 
-        // Loop the buffer, if we reached the end.
-        if (m_ulBufferOffset == m_ulBufferSize)
-        {
-            fSaveFrame = TRUE;
-            m_ulBufferOffset = 0;
-        }
+        KeSetEvent(&m_WriterEvent, IO_NO_INCREMENT, FALSE);
+        return;
+    }
 
-        if (fSaveFrame)
-        {
-            InterlockedExchange( (LONG *)&(m_fFrameUsed[m_ulFrameIndex]), TRUE );
-            ulSaveFrameIndex = m_ulFrameIndex;
-            m_ulFrameIndex = (m_ulFrameIndex + 1) % m_ulFrameCount;
-        }
+    ulOffset = ulWriteCount & (m_ulBufferSize - 1);
+    ulFirstBytes = min(ulByteCount, m_ulBufferSize - ulOffset);
 
-        // Write the left over if the next frame is available.
-        if (ulWriteBytes != ulByteCount)
-        {
-            KeAcquireSpinLock(&m_FrameInUseSpinLock, &oldIrql );
-            if (!m_fFrameUsed[m_ulFrameIndex])
-            {
-                KeReleaseSpinLock(&m_FrameInUseSpinLock, oldIrql );
-                RtlCopyMemory
-                (
-                    m_pDataBuffer + m_ulBufferOffset,
-                    pBuffer + ulWriteBytes,
-                    ulByteCount - ulWriteBytes
-                );
-                
-                m_ulBufferOffset += ulByteCount - ulWriteBytes;
-            }
-            else
-            {
-                KeReleaseSpinLock(&m_FrameInUseSpinLock, oldIrql);
-                DPF(D_BLAB, ("[Frame overflow, next frame is in use]"));
-            }
-        }
+    RtlCopyMemory(m_pDataBuffer + ulOffset, pBuffer, ulFirstBytes);
 
-        if (fSaveFrame)
-        {
-            SaveFrame(ulSaveFrameIndex, m_ulFrameSize);
-        }
-    }
-    else
+    if (ulFirstBytes != ulByteCount)
     {
-        KeReleaseSpinLock(&m_FrameInUseSpinLock, oldIrql );
-        DPF(D_BLAB, ("[Frame %d is in use]", m_ulFrameIndex));
+        RtlCopyMemory(m_pDataBuffer, pBuffer + ulFirstBytes, ulByteCount - ulFirstBytes);
     }
 
-} // WriteData
+    ulWriteCount += ulByteCount;
 
+    // Publish the data to the writer.
+    //
+    WriteRelease((volatile LONG *) &m_ulWriteCount, (LONG) ulWriteCount);
 
+    if (ulWriteCount - ulReadCount >= m_ulWakeThreshold)
+    {
+        KeSetEvent(&m_WriterEvent, IO_NO_INCREMENT, FALSE);
+    }
+
+} // WriteData
@@ -17,6 +17,8 @@ to save data to disk.
 #ifndef _SYSVAD_SAVEDATA_H
 #define _SYSVAD_SAVEDATA_H
 
+#include "SysVadShared.h"
+
 //-----------------------------------------------------------------------------
 //  Forward declaration
 //-----------------------------------------------------------------------------
@@ -28,19 +30,6 @@ typedef CSaveData *PCSaveData;
 //  Structs
 //-----------------------------------------------------------------------------
 
-// Parameter to workitem.
-#include <pshpack1.h>
-typedef struct _SAVEWORKER_PARAM {
-    PIO_WORKITEM     WorkItem;
-    ULONG            ulFrameNo;
-    ULONG            ulDataSize;
-    PBYTE            pData;
-    PCSaveData       pSaveData;
-    KEVENT           EventDone;
-} SAVEWORKER_PARAM;
-typedef SAVEWORKER_PARAM *PSAVEWORKER_PARAM;
-#include <poppack.h>
-
 // wave file header.
 #include <pshpack1.h>
 typedef struct _OUTPUT_FILE_HEADER
@@ -70,35 +59,53 @@ typedef OUTPUT_DATA_HEADER *POUTPUT_DATA_HEADER;
 // CSaveData
 //   Saves the wave data to disk.
 //
-IO_WORKITEM_ROUTINE SaveFrameWorkerCallback;
+//   WriteData copies the data into a ring buffer owned by the stream. One
+//   writer thread, shared by all the streams of the driver, empties the
+//   rings into the data files. The stream is the only producer and the
+//   writer thread the only consumer of a ring, so neither side takes a lock.
+//
+KSTART_ROUTINE SaveDataWriterThread;
 
 class CSaveData
 {
 protected:
     UNICODE_STRING              m_FileName;         // DataFile name.
     HANDLE                      m_FileHandle;       // DataFile handle.
-    PBYTE                       m_pDataBuffer;      // Data buffer.
-    ULONG                       m_ulBufferSize;     // Total buffer size.
+    PBYTE                       m_pDataBuffer;      // Ring buffer.
+    ULONG                       m_ulBufferSize;     // Ring buffer size, a power of 2.
+    ULONG                       m_ulWakeThreshold;  // Buffered bytes that wake the writer.
 
-    ULONG                       m_ulFrameIndex;     // Current Frame.
-    ULONG                       m_ulFrameCount;     // Frame count.
-    ULONG                       m_ulFrameSize;
-    ULONG                       m_ulBufferOffset;   // index in buffer.
-    PBOOL                       m_fFrameUsed;       // Frame usage table.
-    KSPIN_LOCK                  m_FrameInUseSpinLock; // Spinlock for synch.
-    KMUTEX                      m_FileSync;         // Synchronizes file access
+    // Bytes ever put into / taken out of the ring. Only WriteData advances
+    // m_ulWriteCount and only the writer advances m_ulReadCount; the ring
+    // offset is the count modulo the ring size.
+    volatile ULONG              m_ulWriteCount;
+    volatile ULONG              m_ulReadCount;
+
+    LIST_ENTRY                  m_WriterListEntry;  // Entry in m_WriterList.
+    BOOL                        m_bWriterListed;
 
     OBJECT_ATTRIBUTES           m_objectAttributes; // Used for opening file.
 
     OUTPUT_FILE_HEADER          m_FileHeader;
     PWAVEFORMATEX               m_waveFormat;
     OUTPUT_DATA_HEADER          m_DataHeader;
-    PLARGE_INTEGER              m_pFilePtr;
+    LARGE_INTEGER               m_FilePtr;
+
+    SYSVAD_SAVEDATA_STATISTICS  m_Statistics;       // This stream only.
 
     static PDEVICE_OBJECT       m_pDeviceObject;
     static ULONG                m_ulStreamId;
     static ULONG                m_ulOffloadStreamId;
-    static PSAVEWORKER_PARAM    m_pWorkItems;
+
+    // Writer thread. m_WriterLock guards m_WriterList and serializes all
+    // the file I/O.
+    static PKTHREAD             m_pWriterThread;
+    static KEVENT               m_WriterEvent;
+    static KMUTEX               m_WriterLock;
+    static LIST_ENTRY           m_WriterList;
+    static volatile BOOL        m_bWriterStop;
+
+    static SYSVAD_SAVEDATA_STATISTICS m_TotalStatistics;
 
     BOOL                        m_fWriteDisabled;
 
@@ -108,11 +115,11 @@ public:
     CSaveData();
     ~CSaveData();
 
-    static NTSTATUS             InitializeWorkItems
+    static NTSTATUS             InitializeWriter
     (
-        _In_  PDEVICE_OBJECT    DeviceObject
+        void
     );
-    static void                 DestroyWorkItems
+    static void                 DestroyWriter
     (
         void
     );
@@ -120,10 +127,14 @@ public:
     (
         _In_ BOOL               fDisable
     );
-    static PSAVEWORKER_PARAM    GetNewWorkItem
+    void                        Flush
     (
         void
     );
+    static void                 GetStatistics
+    (
+        _Out_ PSYSVAD_SAVEDATA_STATISTICS   pStatistics
+    );
     NTSTATUS                    Initialize
     (
         _In_ BOOL               _bOffloaded
@@ -149,9 +160,9 @@ public:
     (
         _In_  ULONG             ulMaxWriteSize
     );  
-    void                        WaitAllWorkItems
+    static NTSTATUS             PropertyHandlerStatistics
     (
-        void
+        _In_  PPCPROPERTY_REQUEST   PropertyRequest
     );
     void                        WriteData
     (
@@ -160,6 +171,10 @@ public:
     );
 
 private:
+    void                        DrainBuffer
+    (
+        void
+    );
     NTSTATUS                    FileClose
     (
         void
@@ -178,14 +193,8 @@ private:
         void
     );
 
-    void                        SaveFrame
-    (
-        _In_ ULONG              ulFrameNo,
-        _In_ ULONG              ulDataSize
-    );
-
     friend
-    IO_WORKITEM_ROUTINE         SaveFrameWorkerCallback;
+    KSTART_ROUTINE              SaveDataWriterThread;
 };
 typedef CSaveData *PCSaveData;
 
@@ -43,6 +43,52 @@ DEFINE_GUIDSTRUCT("05DC8943-B9FB-4201-808F-6E91451C4760", PROPSETID_VIDCAP_CUSTO
 
 enum
 {
-    KSPROPERTY_CUSTOMCONTROL_DUMMY
+    KSPROPERTY_CUSTOMCONTROL_DUMMY,
+    KSPROPERTY_CUSTOMCONTROL_FRAMETIMING
 };
 
+//
+//  KSPROPERTY_CUSTOMCONTROL_FRAMETIMING
+//
+//  Read-only.  A summary of the last frames each running pin completed.
+//  All times are in 100ns units.
+//
+//  Interval is the time between two frame completions and Jitter is how far
+//  an interval strays from the nominal frame time.  Latency runs from the
+//  simulated interrupt to the completion of the frame.  The stage means
+//  split the latency: the interrupt to the end of synthesis, the end of
+//  synthesis to the end of the commit to the frame buffer and the end of the
+//  commit to the completion.  QueueWaitMean is how long a frame buffer waits
+//  between CCapturePin::Process and the interrupt that fills it.
+//
+#define FRAMETIMING_MAX_PINS    3
+
+typedef struct
+{
+    ULONG       PinId;
+    ULONG       Frames;             // Frames in this summary.
+    ULONGLONG   TotalFrames;        // Frames completed since the pin started.
+    LONGLONG    NominalInterval;
+    LONGLONG    IntervalMin;
+    LONGLONG    IntervalP50;
+    LONGLONG    IntervalP99;
+    LONGLONG    IntervalMax;
+    LONGLONG    JitterP50;
+    LONGLONG    JitterP99;
+    LONGLONG    JitterMax;
+    LONGLONG    LatencyP50;
+    LONGLONG    LatencyP95;
+    LONGLONG    LatencyP99;
+    LONGLONG    LatencyMax;
+    LONGLONG    SynthesisMean;
+    LONGLONG    CommitMean;
+    LONGLONG    CompletionMean;
+    LONGLONG    QueueWaitMean;
+} KSPROPERTY_CUSTOMCONTROL_FRAMETIMING_PIN, *PKSPROPERTY_CUSTOMCONTROL_FRAMETIMING_PIN;
+
+typedef struct
+{
+    ULONG       PinCount;
+    KSPROPERTY_CUSTOMCONTROL_FRAMETIMING_PIN    Pins[FRAMETIMING_MAX_PINS];
+} KSPROPERTY_CUSTOMCONTROL_FRAMETIMING_S, *PKSPROPERTY_CUSTOMCONTROL_FRAMETIMING_S;
+
@@ -53,6 +53,61 @@ AvsCameraDeviceDescriptor =
     NULL
 };
 
+/**************************************************************************
+
+    PAGEABLE CODE
+
+**************************************************************************/
+
+//
+//  KsInitializeDriver installs its own unload routine.  We run ours first
+//  and then chain to it.
+//
+static PDRIVER_UNLOAD g_KsDriverUnload = nullptr;
+
+DRIVER_UNLOAD AvsCameraDriverUnload;
+
+#ifdef ALLOC_PRAGMA
+#pragma code_seg("PAGE")
+#endif // ALLOC_PRAGMA
+
+void
+AvsCameraDriverUnload(
+    _In_ PDRIVER_OBJECT DriverObject
+)
+
+/*++
+
+Routine Description:
+
+    Driver unload.  Unregister the trace provider and let AVStream finish.
+
+Arguments:
+
+    DriverObject -
+        The WDM driver object for our driver
+
+Return Value:
+
+    None
+
+--*/
+
+{
+    PAGED_CODE();
+
+    if( g_KsDriverUnload )
+    {
+        g_KsDriverUnload( DriverObject );
+    }
+
+    TraceLoggingUnregister( g_AvsCameraTraceProvider );
+}
+
+#ifdef ALLOC_PRAGMA
+#pragma code_seg()
+#endif // ALLOC_PRAGMA
+
 /**************************************************************************
 
     INITIALIZATION CODE
@@ -91,18 +146,35 @@ Return Value:
 --*/
 
 {
+    //
+    // The provider carries the FrameTiming events.  Tracing is optional, so
+    // a failure to register it is not fatal.
+    //
+    TraceLoggingRegister( g_AvsCameraTraceProvider );
+
     //
     // Simply pass the device descriptor and parameters off to AVStream
     // to initialize us.  This will cause filter factories to be set up
     // at add & start.  Everything is done based on the descriptors passed
     // here.
     //
-    return
+    NTSTATUS Status =
         KsInitializeDriver (
             DriverObject,
             RegistryPath,
             &AvsCameraDeviceDescriptor
         );
 
+    if( NT_SUCCESS(Status) )
+    {
+        g_KsDriverUnload = DriverObject->DriverUnload;
+        DriverObject->DriverUnload = AvsCameraDriverUnload;
+    }
+    else
+    {
+        TraceLoggingUnregister( g_AvsCameraTraceProvider );
+    }
+
+    return Status;
 }
 
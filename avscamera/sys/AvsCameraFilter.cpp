@@ -142,6 +142,40 @@ SetCustomDummy(
     return STATUS_SUCCESS;
 }
 
+//  Get KSPROPERTY_CUSTOMCONTROL_FRAMETIMING.
+NTSTATUS
+CAvsCameraFilter::
+GetFrameTiming(
+    _Inout_ KSPROPERTY_CUSTOMCONTROL_FRAMETIMING_S *pTiming
+)
+{
+    PAGED_CODE();
+
+    NTSTATUS    Status = STATUS_SUCCESS;
+
+    RtlZeroMemory( pTiming, sizeof(*pTiming) );
+
+    //  Hold the filter so no pin goes away while we read it.
+    LockFilter Lock(m_pKSFilter);
+
+    for( ULONG i = 0; i < m_Sensor->GetPinCount() && pTiming->PinCount < FRAMETIMING_MAX_PINS; i++ )
+    {
+        CCapturePin *pPin = getPin( i );
+
+        if( pPin )
+        {
+            Status = pPin->GetFrameTiming( &pTiming->Pins[pTiming->PinCount] );
+            if( !NT_SUCCESS(Status) )
+            {
+                break;
+            }
+            pTiming->PinCount++;
+        }
+    }
+
+    return Status;
+}
+
 /**************************************************************************
 
     DESCRIPTOR AND DISPATCH LAYOUT
@@ -332,7 +366,8 @@ DEFINE_KSPROPERTY_TABLE( VideoProcampPropertyTable )
 
 DEFINE_KSPROPERTY_TABLE( CustomPropertyTable )
 {
-    DEFINE_PROP_ITEM(CAvsCameraFilter, KSPROPERTY_CUSTOMCONTROL_DUMMY, ULONG, CustomDummy)
+    DEFINE_PROP_ITEM(CAvsCameraFilter, KSPROPERTY_CUSTOMCONTROL_DUMMY, ULONG, CustomDummy),
+    DEFINE_PROP_ITEM_NO_SET(CAvsCameraFilter, KSPROPERTY_CUSTOMCONTROL_FRAMETIMING, KSPROPERTY_CUSTOMCONTROL_FRAMETIMING_S, FrameTiming)
 };
 
 DEFINE_KSEVENT_TABLE(VidCapRoiEventTable)
@@ -52,6 +52,9 @@ public:
     //  Example of adding a new, custom property.
     DECLARE_PROPERTY_HANDLERS( ULONG, CustomDummy )
 
+    //  Frame timing of the pins; see KSPROPERTY_CUSTOMCONTROL_FRAMETIMING.
+    DECLARE_PROPERTY_GET_HANDLER( KSPROPERTY_CUSTOMCONTROL_FRAMETIMING_S, FrameTiming )
+
 protected:
     DWORD       m_CustomValue;
 };
@@ -551,6 +551,7 @@ Return Value:
         }
         else
         {
+            m_FrameTiming.Reset();
             Status = m_Sensor->Start (m_Pin);
         }
 
@@ -659,6 +660,9 @@ Return Value:
                     reinterpret_cast <PUCHAR> (
                         ClonePointer->StreamHeader->Data
                     );
+
+                RtlZeroMemory( &SPContext->Timing, sizeof(SPContext->Timing) );
+                SPContext->Timing.Queued = CFrameTimingLog::Now();
             }
         }
         else
@@ -888,6 +892,12 @@ Return Value:
                 FrameInfo->DropCount = (LONGLONG)m_DroppedFrames;
             }
 
+            PSTREAM_POINTER_CONTEXT SPContext =
+                reinterpret_cast <PSTREAM_POINTER_CONTEXT> (Clone->Context);
+
+            SPContext->Timing.Completed = CFrameTimingLog::Now();
+            m_FrameTiming.Record( m_Pin->Id, m_FrameNumber, SPContext->Timing );
+
             KsStreamPointerDelete (Clone);
         }
         else
@@ -926,6 +936,39 @@ Return Value:
     return Status;
 }
 
+NTSTATUS
+CCapturePin::
+GetFrameTiming(
+    _Out_   PKSPROPERTY_CUSTOMCONTROL_FRAMETIMING_PIN pTiming
+)
+/*++
+
+Routine Description:
+
+    Summarize the timing of the last frames this pin completed for
+    KSPROPERTY_CUSTOMCONTROL_FRAMETIMING.
+
+Arguments:
+
+    pTiming -
+        The summary to fill in.
+
+Return Value:
+
+    Success / failure
+
+--*/
+{
+    PAGED_CODE();
+
+    return
+        m_FrameTiming.Summarize(
+            m_Pin->Id,
+            m_VideoInfoHeader ? m_VideoInfoHeader->AvgTimePerFrame : 0,
+            pTiming
+        );
+}
+
 
 bool
 CCapturePin::
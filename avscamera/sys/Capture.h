@@ -71,6 +71,11 @@ typedef struct _STREAM_POINTER_CONTEXT
 
     PUCHAR BufferVirtual;
 
+    //
+    // When the frame went through each stage of the pipeline.
+    //
+    FRAME_TIMING Timing;
+
 } STREAM_POINTER_CONTEXT, *PSTREAM_POINTER_CONTEXT;
 
 //
@@ -108,6 +113,11 @@ protected:
 
     ULONG   m_DesiredFrames;
 
+    //
+    // The timing of the last frames completed since the pin started.
+    //
+    CFrameTimingLog m_FrameTiming;
+
     //
     // ReleaseAllFrames():
     //
@@ -242,6 +252,12 @@ public:
         return m_PinState;
     }
 
+    //  Summarize the timing of the last frames.
+    NTSTATUS
+    GetFrameTiming(
+        _Out_   PKSPROPERTY_CUSTOMCONTROL_FRAMETIMING_PIN pTiming
+    );
+
     static
     NTSTATUS
     DispatchClose(
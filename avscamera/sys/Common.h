@@ -38,6 +38,7 @@
 #include <mmreg.h>
 #undef NOBITMAP
 #include <acpitabl.h>
+#include <TraceLoggingProvider.h>
 
 #include "MetadataInternal.h"
 #include "CustomProperties.h"
@@ -671,6 +672,7 @@ private:
 #include "Waitable.h"
 #include "WorkItem.h"
 #include "Timer.h"
+#include "FrameTiming.h"
 #include "ExtendedProperty.h"
 #include "ExtendedVidProcSetting.h"
 #include "ExtendedEvComp.h"
@@ -680,6 +682,7 @@ private:
 #include "ExtendedFieldOfView.h"
 #include "ExtendedCameraAngleOffset.h"
 #include "CameraProfile.h"
+#include "SynthesisKernels.h"
 #include "Synthesizer.h"
 #include "XRGBSynthesizer.h"
 #include "RGB24Synthesizer.h"
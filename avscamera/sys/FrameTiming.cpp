@@ -0,0 +1,343 @@
+/**************************************************************************
+
+    A/V Stream Camera Sample
+
+    Copyright (c) 2014, Microsoft Corporation.
+
+    File:
+
+        FrameTiming.cpp
+
+    Abstract:
+
+        Per-pin log of frame timing and the TraceLogging provider its
+        FrameTiming events go to.
+
+    History:
+
+        created 10/14/2026
+
+**************************************************************************/
+
+#include "Common.h"
+
+TRACELOGGING_DEFINE_PROVIDER(
+    g_AvsCameraTraceProvider,
+    "Microsoft.Windows.Samples.AvsCamera",
+    (0xaa8d260a, 0x1923, 0x4e7f, 0x97, 0x98, 0x74, 0x57, 0xa3, 0x67, 0xd9, 0xbd) );
+
+/**************************************************************************
+
+    PAGEABLE CODE
+
+**************************************************************************/
+
+#ifdef ALLOC_PRAGMA
+#pragma code_seg("PAGE")
+#endif // ALLOC_PRAGMA
+
+//
+//  Collect the intervals, in performance counter ticks, between two stages
+//  of every frame that went through both.
+//
+static
+ULONG
+GatherStage(
+    _In_reads_(Count)
+    const FRAME_TIMING *Frames,
+    _In_    ULONG       Count,
+    _In_    LONGLONG    FRAME_TIMING::*From,
+    _In_    LONGLONG    FRAME_TIMING::*To,
+    _Out_writes_to_(Count, return)
+    PLONGLONG   Values
+)
+{
+    PAGED_CODE();
+
+    ULONG   n = 0;
+
+    for( ULONG i = 0; i < Count; i++ )
+    {
+        if( Frames[i].*From && Frames[i].*To )
+        {
+            Values[n++] = Frames[i].*To - Frames[i].*From;
+        }
+    }
+    return n;
+}
+
+//
+//  The logs are small; an insertion sort is plenty.
+//
+static
+void
+SortValues(
+    _Inout_updates_(Count)
+    PLONGLONG   Values,
+    _In_    ULONG       Count
+)
+{
+    PAGED_CODE();
+
+    for( ULONG i = 1; i < Count; i++ )
+    {
+        LONGLONG    Value = Values[i];
+        ULONG       j = i;
+
+        for( ; j > 0 && Values[j-1] > Value; j-- )
+        {
+            Values[j] = Values[j-1];
+        }
+        Values[j] = Value;
+    }
+}
+
+//
+//  Nearest rank percentile of a sorted, non-empty list.
+//
+static
+LONGLONG
+Percentile(
+    _In_reads_(Count)
+    const LONGLONG *Sorted,
+    _In_    ULONG       Count,
+    _In_    ULONG       Percent
+)
+{
+    PAGED_CODE();
+
+    return Sorted[ ((Count - 1) * Percent + 50) / 100 ];
+}
+
+CFrameTimingLog::
+CFrameTimingLog()
+{
+    PAGED_CODE();
+
+    Reset();
+}
+
+void
+CFrameTimingLog::
+Reset()
+/*++
+
+Routine Description:
+
+    Forget all logged frames and refresh the counter frequency.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    void
+
+--*/
+{
+    PAGED_CODE();
+
+    KScopedMutex    Lock( m_Lock );
+
+    LARGE_INTEGER   Frequency;
+    KeQueryPerformanceCounter( &Frequency );
+
+    m_Frequency = Frequency.QuadPart;
+    m_TotalFrames = 0;
+    m_Next = 0;
+    m_Count = 0;
+}
+
+void
+CFrameTimingLog::
+Record(
+    _In_    ULONG           PinId,
+    _In_    LONGLONG        FrameNumber,
+    _In_    const FRAME_TIMING &Timing
+)
+/*++
+
+Routine Description:
+
+    Add a completed frame to the log, replacing the oldest one once the log
+    is full, and write its FrameTiming event.
+
+Arguments:
+
+    PinId -
+        The pin that completed the frame.
+
+    FrameNumber -
+        The pin's frame number.
+
+    Timing -
+        The frame's stage timestamps.
+
+Return Value:
+
+    void
+
+--*/
+{
+    PAGED_CODE();
+
+    {
+        KScopedMutex    Lock( m_Lock );
+
+        m_Log[m_Next] = Timing;
+        m_Next = (m_Next + 1) % FRAME_TIMING_LOG_SIZE;
+        m_Count = min( m_Count + 1, (ULONG) FRAME_TIMING_LOG_SIZE );
+        m_TotalFrames++;
+    }
+
+    //  The stage times are in 100ns units; 0 marks a stage the frame skipped.
+    TraceLoggingWrite(
+        g_AvsCameraTraceProvider,
+        "FrameTiming",
+        TraceLoggingLevel( WINEVENT_LEVEL_VERBOSE ),
+        TraceLoggingUInt32( PinId, "PinId" ),
+        TraceLoggingInt64( FrameNumber, "FrameNumber" ),
+        TraceLoggingInt64( (Timing.Queued && Timing.Interrupt) ? ToTime( Timing.Interrupt - Timing.Queued ) : 0, "QueueWait" ),
+        TraceLoggingInt64( (Timing.Interrupt && Timing.Synthesized) ? ToTime( Timing.Synthesized - Timing.Interrupt ) : 0, "Synthesis" ),
+        TraceLoggingInt64( (Timing.Synthesized && Timing.Filled) ? ToTime( Timing.Filled - Timing.Synthesized ) : 0, "Commit" ),
+        TraceLoggingInt64( (Timing.Filled && Timing.Completed) ? ToTime( Timing.Completed - Timing.Filled ) : 0, "Completion" ),
+        TraceLoggingInt64( (Timing.Interrupt && Timing.Completed) ? ToTime( Timing.Completed - Timing.Interrupt ) : 0, "Latency" )
+    );
+}
+
+NTSTATUS
+CFrameTimingLog::
+Summarize(
+    _In_    ULONG       PinId,
+    _In_    LONGLONG    NominalInterval,
+    _Out_   PKSPROPERTY_CUSTOMCONTROL_FRAMETIMING_PIN pSummary
+)
+/*++
+
+Routine Description:
+
+    Compute the interval, jitter and latency percentiles and the stage
+    means of the logged frames.
+
+Arguments:
+
+    PinId -
+        The pin to report.
+
+    NominalInterval -
+        The pin's frame time, in 100ns units.
+
+    pSummary -
+        The summary to fill in.
+
+Return Value:
+
+    Success / failure
+
+--*/
+{
+    PAGED_CODE();
+
+    NTSTATUS        Status = STATUS_SUCCESS;
+    PFRAME_TIMING   Frames = nullptr;
+    PLONGLONG       Values = nullptr;
+    ULONG           Count = 0;
+    ULONG           n = 0;
+
+    RtlZeroMemory( pSummary, sizeof(*pSummary) );
+    pSummary->PinId = PinId;
+    pSummary->NominalInterval = NominalInterval;
+
+    IFNULL_EXIT( Frames = new (PagedPool, 'miTF') FRAME_TIMING[FRAME_TIMING_LOG_SIZE] );
+    IFNULL_EXIT( Values = new (PagedPool, 'miTF') LONGLONG[FRAME_TIMING_LOG_SIZE] );
+
+    //  Copy the log out, oldest frame first.
+    {
+        KScopedMutex    Lock( m_Lock );
+
+        Count = m_Count;
+        for( ULONG i = 0; i < Count; i++ )
+        {
+            Frames[i] = m_Log[(m_Next + FRAME_TIMING_LOG_SIZE - Count + i) % FRAME_TIMING_LOG_SIZE];
+        }
+        pSummary->Frames = Count;
+        pSummary->TotalFrames = m_TotalFrames;
+    }
+
+    //  Frame to frame intervals and their jitter.
+    for( ULONG i = 1; i < Count; i++ )
+    {
+        if( Frames[i-1].Completed && Frames[i].Completed )
+        {
+            Values[n++] = ToTime( Frames[i].Completed - Frames[i-1].Completed );
+        }
+    }
+    if( n )
+    {
+        SortValues( Values, n );
+        pSummary->IntervalMin = Values[0];
+        pSummary->IntervalP50 = Percentile( Values, n, 50 );
+        pSummary->IntervalP99 = Percentile( Values, n, 99 );
+        pSummary->IntervalMax = Values[n-1];
+
+        if( NominalInterval )
+        {
+            for( ULONG i = 0; i < n; i++ )
+            {
+                Values[i] = ABS( Values[i] - NominalInterval );
+            }
+            SortValues( Values, n );
+            pSummary->JitterP50 = Percentile( Values, n, 50 );
+            pSummary->JitterP99 = Percentile( Values, n, 99 );
+            pSummary->JitterMax = Values[n-1];
+        }
+    }
+
+    //  End to end latency.
+    n = GatherStage( Frames, Count, &FRAME_TIMING::Interrupt, &FRAME_TIMING::Completed, Values );
+    if( n )
+    {
+        SortValues( Values, n );
+        pSummary->LatencyP50 = ToTime( Percentile( Values, n, 50 ) );
+        pSummary->LatencyP95 = ToTime( Percentile( Values, n, 95 ) );
+        pSummary->LatencyP99 = ToTime( Percentile( Values, n, 99 ) );
+        pSummary->LatencyMax = ToTime( Values[n-1] );
+    }
+
+    //  Stage means.  The table is scoped so IFNULL_EXIT can jump past it.
+    {
+        struct
+        {
+            LONGLONG FRAME_TIMING::*From;
+            LONGLONG FRAME_TIMING::*To;
+            PLONGLONG   pMean;
+        }
+        Stages[] =
+        {
+            { &FRAME_TIMING::Interrupt,   &FRAME_TIMING::Synthesized, &pSummary->SynthesisMean },
+            { &FRAME_TIMING::Synthesized, &FRAME_TIMING::Filled,      &pSummary->CommitMean },
+            { &FRAME_TIMING::Filled,      &FRAME_TIMING::Completed,   &pSummary->CompletionMean },
+            { &FRAME_TIMING::Queued,      &FRAME_TIMING::Interrupt,   &pSummary->QueueWaitMean }
+        };
+
+        for( ULONG s = 0; s < SIZEOF_ARRAY(Stages); s++ )
+        {
+            n = GatherStage( Frames, Count, Stages[s].From, Stages[s].To, Values );
+            if( n )
+            {
+                LONGLONG    Sum = 0;
+                for( ULONG i = 0; i < n; i++ )
+                {
+                    Sum += Values[i];
+                }
+                *Stages[s].pMean = ToTime( Sum / n );
+            }
+        }
+    }
+
+done:
+    SAFE_DELETE_ARRAY( Values );
+    SAFE_DELETE_ARRAY( Frames );
+    return Status;
+}
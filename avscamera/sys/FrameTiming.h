@@ -0,0 +1,104 @@
+/**************************************************************************
+
+    A/V Stream Camera Sample
+
+    Copyright (c) 2014, Microsoft Corporation.
+
+    File:
+
+        FrameTiming.h
+
+    Abstract:
+
+        Per-frame timing of the capture pipeline.
+
+        Each frame buffer carries a FRAME_TIMING in its clone stream pointer
+        context.  The stages are stamped with the performance counter as
+        the buffer moves from CCapturePin::Process, through the simulated
+        interrupt, synthesis and commit, to CCapturePin::CompleteMapping.
+        The pin then adds the record to its CFrameTimingLog, which keeps the
+        last FRAME_TIMING_LOG_SIZE frames for KSPROPERTY_CUSTOMCONTROL_
+        FRAMETIMING and writes a FrameTiming event for each frame to the
+        AvsCamera TraceLogging provider.
+
+    History:
+
+        created 10/14/2026
+
+**************************************************************************/
+
+#pragma once
+
+//
+//  "Microsoft.Windows.Samples.AvsCamera"
+//  {AA8D260A-1923-4E7F-9798-7457A367D9BD}
+//
+TRACELOGGING_DECLARE_PROVIDER( g_AvsCameraTraceProvider );
+
+//
+//  The number of frames summarized per pin; about 8 seconds at 30fps.
+//
+#define FRAME_TIMING_LOG_SIZE   256
+
+//
+//  Performance counter values at each stage of a frame.  A stage the frame
+//  skipped is 0.
+//
+typedef struct _FRAME_TIMING
+{
+    LONGLONG    Queued;         // CCapturePin::Process queued the buffer.
+    LONGLONG    Interrupt;      // The simulated interrupt fired.
+    LONGLONG    Synthesized;    // The image was synthesized.
+    LONGLONG    Filled;         // The image was committed to the buffer.
+    LONGLONG    Completed;      // CCapturePin::CompleteMapping released it.
+} FRAME_TIMING, *PFRAME_TIMING;
+
+class CFrameTimingLog : public CNonCopyable
+{
+    KMutex          m_Lock;
+    LONGLONG        m_Frequency;
+    ULONGLONG       m_TotalFrames;
+    ULONG           m_Next;
+    ULONG           m_Count;
+    FRAME_TIMING    m_Log[FRAME_TIMING_LOG_SIZE];
+
+    //  Convert a performance counter interval to 100ns units.
+    LONGLONG
+    ToTime(
+        _In_    LONGLONG    Ticks
+    )
+    {
+        return (Ticks * ONESECOND) / m_Frequency;
+    }
+
+public:
+    CFrameTimingLog();
+
+    //  The current performance counter value.
+    static
+    LONGLONG
+    Now()
+    {
+        return KeQueryPerformanceCounter( nullptr ).QuadPart;
+    }
+
+    //  Forget all frames.  Called when the pin starts running.
+    void
+    Reset();
+
+    //  Log a completed frame and emit its FrameTiming event.
+    void
+    Record(
+        _In_    ULONG           PinId,
+        _In_    LONGLONG        FrameNumber,
+        _In_    const FRAME_TIMING &Timing
+    );
+
+    //  Summarize the logged frames.
+    NTSTATUS
+    Summarize(
+        _In_    ULONG       PinId,
+        _In_    LONGLONG    NominalInterval,
+        _Out_   PKSPROPERTY_CUSTOMCONTROL_FRAMETIMING_PIN pSummary
+    );
+};
@@ -56,11 +56,13 @@
 _Success_(return > 0)
 ULONG
 CNV12Synthesizer::
-Commit(
+CommitRows(
     _Out_writes_bytes_(Size)
     PUCHAR  Buffer,
     _In_    ULONG   Size,
-    _In_    ULONG   Stride
+    _In_    ULONG   Stride,
+    _In_    ULONG   LocY,
+    _In_    ULONG   Height
 )
 /*++
 
@@ -69,6 +71,10 @@ Routine Description:
     Copy (and reformat, if necessary) pixels from the internal scratch
     buffer.  If the output format decimates chrominance, do it here.
 
+    Only the output rows that come from rows LocY to LocY+Height-1 of the
+    scratch buffer are written.  The range is widened to whole
+    macro-pixel rows.
+
 Arguments:
 
     Buffer -
@@ -80,9 +86,15 @@ Arguments:
     Stride -
         The length of a row in bytes.
 
+    LocY -
+        The first scratch buffer row to convert.
+
+    Height -
+        The number of scratch buffer rows to convert.
+
 Return Value:
 
-    Number of bytes copied into Buffer.
+    Number of bytes a full commit copies into Buffer.
 
 --*/
 {
@@ -138,45 +150,20 @@ Return Value:
         return 0;
     }
 
-    PWORD   pY  = (PWORD) Buffer;
-    PWORD   pUV = (PWORD) (Buffer + Y_size);
+    ULONG   RowBytes = MacroPixelsWide * 2;
+    ULONG   RowLimit = min( MacroPixelsHigh, (LocY + Height + 1)/2 );
 
-    for(ULONG row = 0; row < MacroPixelsHigh; row++)
+    for(ULONG row = LocY/2; row < RowLimit; row++)
     {
         PKS_RGBQUAD pSrc = (PKS_RGBQUAD) GetImageLocation(0, row*2);
-        for(ULONG col = 0; col < MacroPixelsWide; col++)
-        {
-            KS_RGBQUAD  TL = pSrc[0];
-            KS_RGBQUAD  TR = pSrc[1];
-            KS_RGBQUAD  BL = pSrc[m_Width+0];
-            KS_RGBQUAD  BR = pSrc[m_Width+1];
-            pSrc += 2;
-
-            //  Copy luma first
-            pY[0]               = MAKEWORD(TL.rgbGreen, TR.rgbGreen);
-            pY[MacroPixelsWide] = MAKEWORD(BL.rgbGreen, BR.rgbGreen);
-            pY++;
-
-            LONG
-            tU  = TL.rgbBlue;    //top left
-            tU += BL.rgbBlue;    //bottom left
-            tU += TR.rgbBlue;    //top right
-            tU += BR.rgbBlue;    //bottom right
-
-            LONG
-            tV  = TL.rgbRed;     //top left
-            tV += BL.rgbRed;     //bottom left
-            tV += TR.rgbRed;     //top right
-            tV += BR.rgbRed;     //bottom right
-
-            //  Copy decimated chroma
-            *pUV++ = MAKEWORD(((tU+2)>>2), ((tV+2)>>2));
-        }
-        //  Skip a scan line, since we've already copied it.
-        pY += MacroPixelsWide;
+        PUCHAR      pY   = Buffer + (row * RowBytes * 2);
+        PUCHAR      pUV  = Buffer + Y_size + (row * RowBytes);
+
+        //  Convert a row of macro-pixels: two luma rows and a chroma row.
+        ConvertRowsToNV12( pY, pY + RowBytes, pUV, pSrc, pSrc + m_Width, MacroPixelsWide );
     }
 
-    return (ULONG) (((PUCHAR) pUV) - Buffer);
+    return YUV_size;
 }
 // suppressed due to Esp:773
 #pragma warning (pop)
@@ -42,11 +42,13 @@
 _Success_(return > 0)
 ULONG
 CRGB24Synthesizer::
-Commit(
+CommitRows(
     _Out_writes_bytes_(Size)
     PUCHAR  Buffer,
     _In_    ULONG   Size,
-    _In_    ULONG   Stride
+    _In_    ULONG   Stride,
+    _In_    ULONG   LocY,
+    _In_    ULONG   Height
 )
 /*++
 
@@ -55,6 +57,10 @@ Routine Description:
     Copy (and reformat, if necessary) pixels from the internal scratch
     buffer.  If the output format decimates chrominance, do it here.
 
+    Only the output rows that come from rows LocY to LocY+Height-1 of the
+    scratch buffer are written.  With a bottom-up bitmap, these are
+    not the output rows LocY to LocY+Height-1.
+
 Arguments:
 
     Buffer -
@@ -66,9 +72,15 @@ Arguments:
     Stride -
         The length of a row in bytes.
 
+    LocY -
+        The first scratch buffer row to convert.
+
+    Height -
+        The number of scratch buffer rows to convert.
+
 Return Value:
 
-    Number of bytes copied into Buffer.
+    Number of bytes a full commit copies into Buffer.
 
 --*/
 {
@@ -94,36 +106,14 @@ Return Value:
     }
 
     ULONG   limit = min( Size/Stride, m_Height );
-    for( ULONG row=0; row<limit; row++ )
+    ULONG   end   = min( m_Height, LocY + Height );
+    for( ULONG y=LocY; y<end; y++ )
     {
-        PDWORD  pSrc = (PDWORD) GetImageLocation( 0, m_FlipVertical ? (m_Height - row -1) : row );
-        PUCHAR  pDst = Buffer + (row * Stride);
-        ULONG   col  = min( m_Width, Stride/3 );
+        ULONG   row = m_FlipVertical ? (m_Height - y -1) : y;
 
-        while( col )
+        if( row<limit )
         {
-            //  This optimizes the copy fairly well on most machines.
-            if( col>=4 )
-            {
-                DWORD   P0 = pSrc[0];
-                DWORD   P1 = pSrc[1];
-                DWORD   P2 = pSrc[2];
-                DWORD   P3 = pSrc[3];
-                ((PDWORD) pDst)[0] = ((P0      ) & 0x00FFFFFF) | (P1 << 24);
-                ((PDWORD) pDst)[1] = ((P1 >>  8) & 0x0000FFFF) | (P2 << 16);
-                ((PDWORD) pDst)[2] = ((P2 >> 16) & 0x000000FF) | (P3 <<  8);
-                pDst += 4 * 3;
-                pSrc += 4;
-                col  -= 4;
-            }
-            else
-            {
-                DWORD   P0 = *pSrc++;
-                *pDst++ = (UCHAR) (P0);
-                *pDst++ = (UCHAR) (P0 >> 8);
-                *pDst++ = (UCHAR) (P0 >> 16);
-                col--;
-            }
+            ConvertRowToRGB24( Buffer + (row * Stride), (PKS_RGBQUAD) GetImageLocation( 0, y ), min( m_Width, Stride/3 ) );
         }
     }
 
@@ -0,0 +1,368 @@
+/**************************************************************************
+
+    A/V Stream Camera Sample
+
+    Copyright (c) 2014, Microsoft Corporation.
+
+    File:
+
+        SynthesisKernels.cpp
+
+    Abstract:
+
+        This file contains the row kernels used by the synthesizers to fill
+        the synthesis buffer and to convert it to the output formats.
+
+        Each kernel has an SSE2 loop that handles whole vectors, on x64, and
+        a portable loop that handles the rest of the row.
+
+    History:
+
+        created 10/14/2026
+
+**************************************************************************/
+
+#include "Common.h"
+
+#if defined(_M_X64)
+#include <emmintrin.h>
+#endif // _M_X64
+
+/**************************************************************************
+
+    LOCKED CODE
+
+    NV12 commits from locked code, so the kernels must be resident.
+
+**************************************************************************/
+
+#ifdef ALLOC_PRAGMA
+#pragma code_seg()
+#endif // ALLOC_PRAGMA
+
+void
+FillRow(
+    _Out_writes_(Count)
+    PKS_RGBQUAD Dst,
+    _In_    ULONG       Count,
+    _In_    KS_RGBQUAD  Pixel
+)
+/*++
+
+Routine Description:
+
+    Store Count copies of a pixel.
+
+Arguments:
+
+    Dst -
+        The first pixel to fill.
+
+    Count -
+        The number of pixels to fill.
+
+    Pixel -
+        The pixel value.
+
+Return Value:
+
+    void
+
+--*/
+{
+    ULONG   i = 0;
+
+#if defined(_M_X64)
+    DWORD   Value;
+    RtlCopyMemory( &Value, &Pixel, sizeof(Value) );
+
+    __m128i P = _mm_set1_epi32( (int) Value );
+
+    for( ; i + 4 <= Count; i += 4 )
+    {
+        _mm_storeu_si128( (__m128i *) &Dst[i], P );
+    }
+#endif // _M_X64
+
+    for( ; i < Count; i++ )
+    {
+        Dst[i] = Pixel;
+    }
+}
+
+void
+ConvertRowToYUY2(
+    _Out_writes_(Pairs)
+    PDWORD      Dst,
+    _In_reads_(Pairs*2)
+    const KS_RGBQUAD *Src,
+    _In_    ULONG       Pairs
+)
+/*++
+
+Routine Description:
+
+    Pack pixel pairs into YUY2 macro-pixels: Y0 U Y1 V.  The synthesis
+    buffer holds Y in rgbGreen, U in rgbBlue and V in rgbRed.
+
+Arguments:
+
+    Dst -
+        The first macro-pixel of the output row.
+
+    Src -
+        The first pixel of the synthesis row.
+
+    Pairs -
+        The number of pixel pairs to convert.
+
+Return Value:
+
+    void
+
+--*/
+{
+    ULONG   i = 0;
+
+#if defined(_M_X64)
+    const __m128i   ByteOne  = _mm_set1_epi8( 1 );
+    const __m128i   Y0Mask   = _mm_set1_epi32( 0x000000FF );
+    const __m128i   Y1Mask   = _mm_set1_epi32( 0x00FF0000 );
+    const __m128i   UVMask   = _mm_set1_epi32( (int) 0xFF00FF00 );
+
+    //  4 pairs per pass.
+    for( ; i + 4 <= Pairs; i += 4 )
+    {
+        __m128i A = _mm_loadu_si128( (const __m128i *) &Src[i*2+0] );
+        __m128i B = _mm_loadu_si128( (const __m128i *) &Src[i*2+4] );
+
+        //  Split into the left and the right pixel of each pair.
+        A = _mm_shuffle_epi32( A, _MM_SHUFFLE(3,1,2,0) );
+        B = _mm_shuffle_epi32( B, _MM_SHUFFLE(3,1,2,0) );
+        __m128i L = _mm_unpacklo_epi64( A, B );
+        __m128i R = _mm_unpackhi_epi64( A, B );
+
+        //  _mm_avg_epu8 rounds up; take the odd bit back off to truncate.
+        __m128i M = _mm_sub_epi8( _mm_avg_epu8( L, R ),
+                                  _mm_and_si128( _mm_xor_si128( L, R ), ByteOne ) );
+
+        __m128i Out = _mm_or_si128(
+                          _mm_or_si128(
+                              _mm_and_si128( _mm_srli_epi32( L, 8 ), Y0Mask ),
+                              _mm_and_si128( _mm_slli_epi32( R, 8 ), Y1Mask ) ),
+                          _mm_and_si128( _mm_slli_epi32( M, 8 ), UVMask ) );
+
+        _mm_storeu_si128( (__m128i *) &Dst[i], Out );
+    }
+#endif // _M_X64
+
+    for( ; i < Pairs; i++ )
+    {
+        KS_RGBQUAD  L = Src[i*2+0];
+        KS_RGBQUAD  R = Src[i*2+1];
+
+        Dst[i] =
+            MAKELONG( MAKEWORD( L.rgbGreen, (ULONG(L.rgbBlue) + R.rgbBlue)/2),
+                      MAKEWORD( R.rgbGreen, (ULONG(L.rgbRed ) + R.rgbRed )/2) );
+    }
+}
+
+void
+ConvertRowsToNV12(
+    _Out_writes_bytes_(MacroPixels*2)
+    PUCHAR      YTop,
+    _Out_writes_bytes_(MacroPixels*2)
+    PUCHAR      YBottom,
+    _Out_writes_bytes_(MacroPixels*2)
+    PUCHAR      UV,
+    _In_reads_(MacroPixels*2)
+    const KS_RGBQUAD *Top,
+    _In_reads_(MacroPixels*2)
+    const KS_RGBQUAD *Bottom,
+    _In_    ULONG       MacroPixels
+)
+/*++
+
+Routine Description:
+
+    Convert a pair of synthesis rows into two rows of luma and one row of
+    decimated chroma.  The synthesis buffer holds Y in rgbGreen, U in
+    rgbBlue and V in rgbRed.
+
+Arguments:
+
+    YTop -
+        The luma row for Top.
+
+    YBottom -
+        The luma row for Bottom.
+
+    UV -
+        The interleaved chroma row.
+
+    Top -
+        The first pixel of the even synthesis row.
+
+    Bottom -
+        The first pixel of the odd synthesis row.
+
+    MacroPixels -
+        The number of 2x2 macro-pixels to convert.
+
+Return Value:
+
+    void
+
+--*/
+{
+    ULONG   i = 0;
+
+#if defined(_M_X64)
+    const __m128i   YMask    = _mm_set1_epi32( 0x000000FF );
+    const __m128i   UVMask   = _mm_set1_epi32( 0x00FF00FF );
+    const __m128i   Round    = _mm_set1_epi16( 2 );
+
+    //  8 macro-pixels (16 pixels wide) per pass.
+    for( ; i + 8 <= MacroPixels; i += 8 )
+    {
+        __m128i T[4];
+        __m128i B[4];
+        __m128i Sum[4];
+
+        for( int k = 0; k < 4; k++ )
+        {
+            T[k] = _mm_loadu_si128( (const __m128i *) &Top   [i*2 + k*4] );
+            B[k] = _mm_loadu_si128( (const __m128i *) &Bottom[i*2 + k*4] );
+        }
+
+        //  Luma: byte 1 of each pixel, narrowed to bytes.
+        _mm_storeu_si128( (__m128i *) &YTop[i*2],
+            _mm_packus_epi16(
+                _mm_packs_epi32( _mm_and_si128( _mm_srli_epi32( T[0], 8 ), YMask ),
+                                 _mm_and_si128( _mm_srli_epi32( T[1], 8 ), YMask ) ),
+                _mm_packs_epi32( _mm_and_si128( _mm_srli_epi32( T[2], 8 ), YMask ),
+                                 _mm_and_si128( _mm_srli_epi32( T[3], 8 ), YMask ) ) ) );
+
+        _mm_storeu_si128( (__m128i *) &YBottom[i*2],
+            _mm_packus_epi16(
+                _mm_packs_epi32( _mm_and_si128( _mm_srli_epi32( B[0], 8 ), YMask ),
+                                 _mm_and_si128( _mm_srli_epi32( B[1], 8 ), YMask ) ),
+                _mm_packs_epi32( _mm_and_si128( _mm_srli_epi32( B[2], 8 ), YMask ),
+                                 _mm_and_si128( _mm_srli_epi32( B[3], 8 ), YMask ) ) ) );
+
+        //  Chroma: sum U and V as 16 bit words down the column, then across
+        //  each pair of pixels.  The even dwords then hold a macro-pixel.
+        for( int k = 0; k < 4; k++ )
+        {
+            __m128i S = _mm_add_epi16( _mm_and_si128( T[k], UVMask ),
+                                       _mm_and_si128( B[k], UVMask ) );
+            S = _mm_add_epi16( S, _mm_srli_epi64( S, 32 ) );
+            S = _mm_srli_epi16( _mm_add_epi16( S, Round ), 2 );
+            Sum[k] = _mm_shuffle_epi32( S, _MM_SHUFFLE(3,1,2,0) );
+        }
+
+        _mm_storeu_si128( (__m128i *) &UV[i*2],
+            _mm_packus_epi16( _mm_unpacklo_epi64( Sum[0], Sum[1] ),
+                              _mm_unpacklo_epi64( Sum[2], Sum[3] ) ) );
+    }
+#endif // _M_X64
+
+    for( ; i < MacroPixels; i++ )
+    {
+        KS_RGBQUAD  TL = Top[i*2+0];
+        KS_RGBQUAD  TR = Top[i*2+1];
+        KS_RGBQUAD  BL = Bottom[i*2+0];
+        KS_RGBQUAD  BR = Bottom[i*2+1];
+
+        YTop   [i*2+0] = TL.rgbGreen;
+        YTop   [i*2+1] = TR.rgbGreen;
+        YBottom[i*2+0] = BL.rgbGreen;
+        YBottom[i*2+1] = BR.rgbGreen;
+
+        LONG    tU = TL.rgbBlue + BL.rgbBlue + TR.rgbBlue + BR.rgbBlue;
+        LONG    tV = TL.rgbRed  + BL.rgbRed  + TR.rgbRed  + BR.rgbRed;
+
+        UV[i*2+0] = (UCHAR) ((tU+2)>>2);
+        UV[i*2+1] = (UCHAR) ((tV+2)>>2);
+    }
+}
+
+void
+ConvertRowToRGB24(
+    _Out_writes_bytes_(Count*3)
+    PUCHAR      Dst,
+    _In_reads_(Count)
+    const KS_RGBQUAD *Src,
+    _In_    ULONG       Count
+)
+/*++
+
+Routine Description:
+
+    Copy pixels to a 24 bit row, dropping the reserved byte.
+
+Arguments:
+
+    Dst -
+        The first byte of the output row.  Must be DWORD aligned.
+
+    Src -
+        The first pixel of the synthesis row.
+
+    Count -
+        The number of pixels to convert.
+
+Return Value:
+
+    void
+
+--*/
+{
+    const DWORD *pSrc = (const DWORD *) Src;
+    ULONG       i = 0;
+
+#if defined(_M_X64)
+    const __m128i   Low24  = _mm_set1_epi64x( 0x0000000000FFFFFF );
+    const __m128i   High24 = _mm_set1_epi64x( 0x0000FFFFFF000000 );
+    const __m128i   Zero   = _mm_setzero_si128();
+
+    //  4 pixels per pass.  Each store writes 16 bytes of which 12 are
+    //  pixels, so stop while the next pass can still overwrite the rest.
+    for( ; i + 8 <= Count; i += 4 )
+    {
+        __m128i X = _mm_loadu_si128( (const __m128i *) &pSrc[i] );
+
+        //  Close the gap between the two pixels of each qword...
+        X = _mm_or_si128( _mm_and_si128( X, Low24 ),
+                          _mm_and_si128( _mm_srli_epi64( X, 8 ), High24 ) );
+
+        //  ... then between the two qwords.
+        X = _mm_or_si128( _mm_move_epi64( X ),
+                          _mm_srli_si128( _mm_unpackhi_epi64( Zero, X ), 2 ) );
+
+        _mm_storeu_si128( (__m128i *) &Dst[i*3], X );
+    }
+#endif // _M_X64
+
+    for( ; i + 4 <= Count; i += 4 )
+    {
+        DWORD   P0 = pSrc[i+0];
+        DWORD   P1 = pSrc[i+1];
+        DWORD   P2 = pSrc[i+2];
+        DWORD   P3 = pSrc[i+3];
+        PDWORD  pDst = (PDWORD) &Dst[i*3];
+
+        pDst[0] = ((P0      ) & 0x00FFFFFF) | (P1 << 24);
+        pDst[1] = ((P1 >>  8) & 0x0000FFFF) | (P2 << 16);
+        pDst[2] = ((P2 >> 16) & 0x000000FF) | (P3 <<  8);
+    }
+
+    for( ; i < Count; i++ )
+    {
+        DWORD   P0 = pSrc[i];
+
+        Dst[i*3+0] = (UCHAR) (P0);
+        Dst[i*3+1] = (UCHAR) (P0 >> 8);
+        Dst[i*3+2] = (UCHAR) (P0 >> 16);
+    }
+}
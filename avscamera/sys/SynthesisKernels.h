@@ -0,0 +1,92 @@
+/**************************************************************************
+
+    A/V Stream Camera Sample
+
+    Copyright (c) 2014, Microsoft Corporation.
+
+    File:
+
+        SynthesisKernels.h
+
+    Abstract:
+
+        Row kernels used by the synthesizers to fill the synthesis buffer
+        and to convert it to the output formats.
+
+        Each kernel works on a whole row of KS_RGBQUAD pixels.  On x64 the
+        kernels use SSE2, which every x64 processor has and which a kernel
+        mode driver may use there without saving the floating point state.
+        Other platforms use the portable versions.  Both give identical
+        output.
+
+    History:
+
+        created 10/14/2026
+
+**************************************************************************/
+
+#pragma once
+
+//
+//  FillRow
+//
+//  Store Count copies of Pixel.
+//
+void
+FillRow(
+    _Out_writes_(Count)
+    PKS_RGBQUAD Dst,
+    _In_    ULONG       Count,
+    _In_    KS_RGBQUAD  Pixel
+);
+
+//
+//  ConvertRowToYUY2
+//
+//  Pack Pairs pixel pairs from the YUV synthesis buffer into YUY2 macro-
+//  pixels.  The chroma of a pair is the truncated mean of its two pixels.
+//
+void
+ConvertRowToYUY2(
+    _Out_writes_(Pairs)
+    PDWORD      Dst,
+    _In_reads_(Pairs*2)
+    const KS_RGBQUAD *Src,
+    _In_    ULONG       Pairs
+);
+
+//
+//  ConvertRowsToNV12
+//
+//  Convert two rows of the YUV synthesis buffer into two rows of the NV12
+//  Y plane and one row of the interleaved UV plane.  The chroma of a 2x2
+//  macro-pixel is the rounded mean of its four pixels.
+//
+void
+ConvertRowsToNV12(
+    _Out_writes_bytes_(MacroPixels*2)
+    PUCHAR      YTop,
+    _Out_writes_bytes_(MacroPixels*2)
+    PUCHAR      YBottom,
+    _Out_writes_bytes_(MacroPixels*2)
+    PUCHAR      UV,
+    _In_reads_(MacroPixels*2)
+    const KS_RGBQUAD *Top,
+    _In_reads_(MacroPixels*2)
+    const KS_RGBQUAD *Bottom,
+    _In_    ULONG       MacroPixels
+);
+
+//
+//  ConvertRowToRGB24
+//
+//  Drop the reserved byte of Count pixels.
+//
+void
+ConvertRowToRGB24(
+    _Out_writes_bytes_(Count*3)
+    PUCHAR      Dst,
+    _In_reads_(Count)
+    const KS_RGBQUAD *Src,
+    _In_    ULONG       Count
+);
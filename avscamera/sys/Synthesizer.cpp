@@ -67,6 +67,11 @@ const COLOR g_TopRight = BLUE;
 const COLOR g_BotLeft  = RED;
 const COLOR g_BotRight = GREEN;
 
+//
+//  Gradient bar colors, from the top bar down.
+//
+const COLOR g_Gradients[] = { RED, GREEN, BLUE, WHITE };
+
 //
 //  Persistent stats.
 //
@@ -386,9 +391,9 @@ Return Value:
         return FALSE;
     }
 
-    m_Buffer = new (PagedPool) UCHAR[m_Length];
-    NT_ASSERT(m_Buffer);
-    if( !m_Buffer )
+    m_ScratchBuffer = new (PagedPool) UCHAR[m_Length];
+    NT_ASSERT(m_ScratchBuffer);
+    if( !m_ScratchBuffer )
     {
         return FALSE;
     }
@@ -400,10 +405,27 @@ Return Value:
     NT_ASSERT(m_GradientBmp);
     if( !m_GradientBmp )
     {
-        SAFE_DELETE_ARRAY( m_Buffer );
+        SAFE_DELETE_ARRAY( m_ScratchBuffer );
         return FALSE;
     }
 
+    //
+    // Allocate and render the color bar rows.
+    //
+    m_BarRowBmp = new (PagedPool) CKsRgbQuad[m_Width * BAR_ROW_COUNT];
+    NT_ASSERT(m_BarRowBmp);
+    if( !m_BarRowBmp )
+    {
+        SAFE_DELETE_ARRAY( m_ScratchBuffer );
+        SAFE_DELETE_ARRAY( m_GradientBmp );
+        return FALSE;
+    }
+    BuildBarRows();
+
+    //  Render into the scratch buffer; nothing has been drawn yet.
+    m_RenderTarget = nullptr;
+    SelectImage( m_ScratchBuffer, m_Width * sizeof(KS_RGBQUAD) );
+
     return TRUE;
 }
 
@@ -443,8 +465,12 @@ Return Value:
 {
     PAGED_CODE();
 
-    SAFE_DELETE_ARRAY( m_Buffer );
+    SAFE_DELETE_ARRAY( m_ScratchBuffer );
     SAFE_DELETE_ARRAY( m_GradientBmp );
+    SAFE_DELETE_ARRAY( m_BarRowBmp );
+    m_RenderTarget = nullptr;
+    SelectImage( nullptr, m_Width * sizeof(KS_RGBQUAD) );
+    FreeFrameCache();
 
     //  Report rendering times.
     DBG_TRACE( "Synthesis Time - Total = %lld", ConvertPerfTime( m_Frequency.QuadPart, m_SynthesisTime ) );
@@ -482,101 +508,15 @@ Return Value:
         return STATUS_INVALID_DEVICE_STATE;
     }
 
-    const COLOR *CurColor = m_ColorBars;
-    ULONG ColorCount = SIZEOF_ARRAY (m_ColorBars);
-
     //
-    // Set the default cursor...
-    //
-    GetImageLocation (0, 0);
-
-    //
-    // Synthesize a single line.
-    //
-    PUCHAR ImageStart = m_Cursor;
-    for (ULONG x = 0; x < m_Width; x++)
-    {
-        PutPixel (m_ColorBars [((x * ColorCount) / m_Width)]);
-    }
-
-    PUCHAR ImageEnd = m_Cursor;
-
-    //
-    // Copy the synthesized line to all subsequent lines.
+    // Every row is a copy of one of the bar rows.
     //
     for (ULONG line = 0; line < m_Height; line++)
     {
-        GetImageLocation (0, line);
-
         RtlCopyMemory (
-            m_Cursor,
-            ImageStart,
-            ImageEnd - ImageStart
-        );
-    }
-
-    //  Paint the top left and top right registrations boxes.
-    GetImageLocation(0,0);
-
-    ImageStart = m_Cursor;
-    for(ULONG x =0; x < m_Width; x++)
-    {
-        if(x < (m_Height/16))
-        {
-            PutPixel(g_TopLeft);
-        }
-        else if(x > (m_Width - (m_Height / 16)))
-        {
-            PutPixel(g_TopRight);
-        }
-        else
-        {
-            PutPixel (m_ColorBars [((x * ColorCount) / m_Width)]);
-        }
-    }
-
-    ImageEnd = m_Cursor;
-
-    for (ULONG line = 0; line < m_Height/16; line++)
-    {
-        GetImageLocation (0, line);
-
-        RtlCopyMemory (
-            m_Cursor,
-            ImageStart,
-            ImageEnd - ImageStart
-        );
-    }
-
-    //  Paint the bottom left and bottom right registrations boxes.
-    GetImageLocation(0, (15*m_Height) / 16);
-    ImageStart = m_Cursor;
-    for(ULONG x =0; x < m_Width; x++)
-    {
-        if(x < (m_Height/16))
-        {
-            PutPixel(g_BotLeft);
-        }
-        else if(x > (m_Width - (m_Height / 16)))
-        {
-            PutPixel(g_BotRight);
-        }
-        else
-        {
-            PutPixel (m_ColorBars [((x * ColorCount) / m_Width)]);
-        }
-    }
-
-    ImageEnd = m_Cursor;
-
-    for (ULONG line = 0; line < m_Height/16; line++)
-    {
-        GetImageLocation (0, line+(15*m_Height) / 16);
-
-        RtlCopyMemory (
-            m_Cursor,
-            ImageStart,
-            ImageEnd - ImageStart
+            GetImageLocation (0, line),
+            GetBarRow (line),
+            m_Width * sizeof (KS_RGBQUAD)
         );
     }
 
@@ -633,21 +573,13 @@ Return Value:
     PUCHAR ImageStart = m_Cursor;
     for(ULONG i = 0; i < 32; i++)
     {
-        for(ULONG j = 0; j < m_Width/32; j++)
-        {
-            if(Number & mask)
-            {
-                PutPixel(HighColor);
-            }
-            else
-            {
-                PutPixel(LowColor);
-            }
-        }
+        FillPixels(m_Width/32, (Number & mask) ? HighColor : LowColor);
         mask = mask << 1;
     }
     PUCHAR ImageEnd = m_Cursor;
 
+    AddDirtyRect(0, LocY, (m_Width/32) * 32, max(m_Height/16, 1UL));
+
     //
     // Copy the synthesized line to all subsequent lines.
     //
@@ -803,6 +735,11 @@ Return Value:
     ULONG SpaceX = m_Width - LocX;
     ULONG SpaceY = m_Height - LocY;
 
+    //
+    // The overlay will replace this area of the base image.
+    //
+    AddDirtyRect (LocX, LocY, min(LenX, SpaceX), min(LenY, SpaceY));
+
     //
     // Set the default cursor position.
     //
@@ -813,13 +750,7 @@ Return Value:
     //
     if( SpaceY )
     {
-        if( BgColor != TRANSPARENT )
-        {
-            for (ULONG x = 0; x < LenX && x < SpaceX; x++)
-            {
-                PutPixel (BgColor);
-            }
-        }
+        FillPixels (min(LenX, SpaceX), BgColor);
         SpaceY--;
     }
     LocY++;
@@ -833,13 +764,14 @@ Return Value:
         // Generate a line.
         //
         GetImageLocation (LocX, LocY++);
+        SpaceY--;
 
         PUCHAR ImageStart = m_Cursor;
 
         ULONG CurSpaceX = SpaceX;
         if (CurSpaceX)
         {
-            PutPixel (BgColor);
+            FillPixels (1, BgColor);
             CurSpaceX--;
         }
 
@@ -852,18 +784,10 @@ Return Value:
             UCHAR CharBase = m_FontData [*CurChar++][row];
             for (ULONG mask = 0x80; mask && CurSpaceX; mask >>= 1)
             {
-                for (ULONG scale = 0; scale < Scaling && CurSpaceX; scale++)
-                {
-                    if (CharBase & mask)
-                    {
-                        PutPixel (FgColor);
-                    }
-                    else
-                    {
-                        PutPixel (BgColor);
-                    }
-                    CurSpaceX--;
-                }
+                ULONG Run = min(Scaling, CurSpaceX);
+
+                FillPixels (Run, (CharBase & mask) ? FgColor : BgColor);
+                CurSpaceX -= Run;
             }
 
             //
@@ -874,7 +798,7 @@ Return Value:
 #ifndef NO_CHARACTER_SEPARATION
             if (CurSpaceX)
             {
-                PutPixel (BgColor);
+                FillPixels (1, BgColor);
                 CurSpaceX--;
             }
 #endif // NO_CHARACTER_SEPARATION
@@ -887,7 +811,7 @@ Return Value:
 #ifdef NO_CHARACTER_SEPARATION
         if (CurSpaceX)
         {
-            PutPixel (BgColor);
+            FillPixels (1, BgColor);
             CurSpaceX--;
         }
 #endif // NO_CHARACTER_SEPARATION
@@ -909,12 +833,9 @@ Return Value:
     // Add the bottom section of the overlay.
     //
     GetImageLocation (LocX, LocY);
-    if (BgColor != TRANSPARENT && SpaceY)
+    if (SpaceY)
     {
-        for (ULONG x = 0; x < LenX && x < SpaceX; x++)
-        {
-            PutPixel (BgColor);
-        }
+        FillPixels (min(LenX, SpaceX), BgColor);
     }
 }
 
@@ -952,7 +873,6 @@ Return Value:
 
     NT_ASSERT(LocY <= m_Height);
 
-    PUCHAR Image = GetImageLocation(0, LocY);
     PUCHAR  RowBmp = reinterpret_cast<PUCHAR>(&m_GradientBmp[Gradient*m_Width]);
     ULONG   Stride = m_Width * sizeof(CKsRgbQuad);
 
@@ -962,14 +882,285 @@ Return Value:
     for (ULONG line = 0; line < m_Height/16; line++)
     {
         RtlCopyMemory (
-            Image,
+            GetImageLocation (0, LocY + line),
             RowBmp,
             Stride
         );
-        Image += Stride;
     }
 }
 
+void
+CSynthesizer::
+FillPixels(
+    _In_ ULONG Count,
+    _In_ COLOR Color
+)
+/*++
+
+Routine Description:
+
+    Place a run of pixels of one color at the default cursor location and
+    advance the cursor past it.  The cursor location must be set via
+    GetImageLocation(x, y).
+
+Arguments:
+
+    Count -
+        The number of pixels to place
+
+    Color -
+        The pixel color to render, or TRANSPARENT to just skip the pixels
+
+Return Value:
+
+    void
+
+--*/
+{
+    PAGED_CODE();
+
+    if (Color != TRANSPARENT)
+    {
+        FillRow ((PKS_RGBQUAD) m_Cursor, Count, GetPixel (Color));
+    }
+
+    m_Cursor += Count * sizeof (KS_RGBQUAD);
+}
+
+void
+CSynthesizer::
+BuildBarRows()
+/*++
+
+Routine Description:
+
+    Render the three color bar rows: the EIA-189-A bars alone, and the bars
+    with the top or the bottom corner registration boxes.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    void
+
+--*/
+{
+    PAGED_CODE();
+
+    PKS_RGBQUAD Bars   = &m_BarRowBmp[BAR_ROW_BARS   * m_Width];
+    PKS_RGBQUAD Top    = &m_BarRowBmp[BAR_ROW_TOP    * m_Width];
+    PKS_RGBQUAD Bottom = &m_BarRowBmp[BAR_ROW_BOTTOM * m_Width];
+    ULONG ColorCount = SIZEOF_ARRAY (m_ColorBars);
+
+    //
+    // Pixel x belongs to bar (x * ColorCount) / m_Width.
+    //
+    for (ULONG bar = 0; bar < ColorCount; bar++)
+    {
+        ULONG Start = ((bar * m_Width) + ColorCount - 1) / ColorCount;
+        ULONG End   = (((bar + 1) * m_Width) + ColorCount - 1) / ColorCount;
+
+        FillRow (&Bars[Start], End - Start, GetPixel (m_ColorBars[bar]));
+    }
+
+    //
+    // The boxes are m_Height/16 pixels wide.  A right box pixel is one
+    // with x > m_Width - m_Height/16, and the left box wins where they meet.
+    //
+    ULONG Box = m_Height / 16;
+    ULONG LeftEnd = min(Box, m_Width);
+    ULONG RightStart = (Box < m_Width) ? min(m_Width - Box + 1, m_Width) : m_Width;
+    if (RightStart < LeftEnd)
+    {
+        RightStart = LeftEnd;
+    }
+
+    RtlCopyMemory (Top, Bars, m_Width * sizeof (KS_RGBQUAD));
+    FillRow (Top, LeftEnd, GetPixel (g_TopLeft));
+    FillRow (&Top[RightStart], m_Width - RightStart, GetPixel (g_TopRight));
+
+    RtlCopyMemory (Bottom, Bars, m_Width * sizeof (KS_RGBQUAD));
+    FillRow (Bottom, LeftEnd, GetPixel (g_BotLeft));
+    FillRow (&Bottom[RightStart], m_Width - RightStart, GetPixel (g_BotRight));
+}
+
+const KS_RGBQUAD *
+CSynthesizer::
+GetBarRow(
+    _In_ ULONG LocY
+)
+/*++
+
+Routine Description:
+
+    Get the row of m_BarRowBmp that row LocY of the color bars is.  The
+    registration boxes cover the first and the bottom m_Height/16 rows.
+
+Arguments:
+
+    LocY -
+        row
+
+Return Value:
+
+    The bar row.
+
+--*/
+{
+    PAGED_CODE();
+
+    ULONG Box = m_Height / 16;
+    ULONG BottomStart = (15 * m_Height) / 16;
+
+    if (LocY >= BottomStart && LocY - BottomStart < Box)
+    {
+        return &m_BarRowBmp[BAR_ROW_BOTTOM * m_Width];
+    }
+    if (LocY < Box)
+    {
+        return &m_BarRowBmp[BAR_ROW_TOP * m_Width];
+    }
+    return &m_BarRowBmp[BAR_ROW_BARS * m_Width];
+}
+
+const KS_RGBQUAD *
+CSynthesizer::
+GetBaseRow(
+    _In_ ULONG LocY
+)
+/*++
+
+Routine Description:
+
+    Get the row that row LocY of the base image is a copy of.  This mirrors
+    the drawing order of Synthesize(): bars first, then each gradient bar.
+
+Arguments:
+
+    LocY -
+        row
+
+Return Value:
+
+    The row of m_GradientBmp or m_BarRowBmp.
+
+--*/
+{
+    PAGED_CODE();
+
+    ULONG Band = m_Height / 16;
+
+    for (int i = (int) SIZEOF_ARRAY (g_Gradients) - 1; i >= 0; i--)
+    {
+        ULONG Start = ((ULONG) (i + 1) * m_Height) / 16;
+
+        if (LocY >= Start && LocY - Start < Band)
+        {
+            return &m_GradientBmp[g_Gradients[i] * m_Width];
+        }
+    }
+
+    return GetBarRow (LocY);
+}
+
+void
+CSynthesizer::
+AddDirtyRect(
+    _In_ ULONG LocX,
+    _In_ ULONG LocY,
+    _In_ ULONG Width,
+    _In_ ULONG Height
+)
+/*++
+
+Routine Description:
+
+    Note an area of the image that an overlay has drawn over.  The area is
+    clipped to the image.  If there are too many areas to track, the whole
+    base image will be redrawn instead.
+
+Arguments:
+
+    LocX, LocY -
+        The top left corner of the area
+
+    Width, Height -
+        The size of the area
+
+Return Value:
+
+    void
+
+--*/
+{
+    PAGED_CODE();
+
+    if (LocX >= m_Width || LocY >= m_Height)
+    {
+        return;
+    }
+
+    Width  = min(Width,  m_Width  - LocX);
+    Height = min(Height, m_Height - LocY);
+
+    if (!Width || !Height)
+    {
+        return;
+    }
+
+    if (m_DirtyCount >= MAX_DIRTY_RECTS)
+    {
+        m_BaseImageValid = FALSE;
+        return;
+    }
+
+    DIRTY_RECT &Rect = m_DirtyRects[m_DirtyCount++];
+    Rect.LocX   = LocX;
+    Rect.LocY   = LocY;
+    Rect.Width  = Width;
+    Rect.Height = Height;
+}
+
+void
+CSynthesizer::
+RestoreDirtyRects()
+/*++
+
+Routine Description:
+
+    Copy the base image back over every area noted by AddDirtyRect.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    void
+
+--*/
+{
+    PAGED_CODE();
+
+    for (ULONG i = 0; i < m_DirtyCount; i++)
+    {
+        const DIRTY_RECT &Rect = m_DirtyRects[i];
+
+        for (ULONG line = Rect.LocY; line < Rect.LocY + Rect.Height; line++)
+        {
+            RtlCopyMemory (
+                GetImageLocation (Rect.LocX, line),
+                &GetBaseRow (line)[Rect.LocX],
+                Rect.Width * sizeof (KS_RGBQUAD)
+            );
+        }
+    }
+
+    m_DirtyCount = 0;
+}
+
 //
 //  Synthesize
 //
@@ -1003,16 +1194,31 @@ Return Value:
         return STATUS_INVALID_DEVICE_STATE;
     }
 
+    //
+    // The bars and gradients don't change from frame to frame.  Draw them
+    // once, then only undo what the last frame's overlays drew over them.
+    //
+    if( m_BaseImageValid )
+    {
+        RestoreDirtyRects();
+    }
+    else
+    {
+        SynthesizeBars();
+
+        for( ULONG i = 0; i < SIZEOF_ARRAY(g_Gradients); i++ )
+        {
+            ApplyGradient( ((i+1)*m_Height)/16, g_Gradients[i] );
+        }
+
+        m_DirtyCount = 0;
+        m_BaseImageValid = TRUE;
+    }
+
     //
     // Generate a "time stamp" just to overlay it onto the capture image.
     // It makes it more exciting than bars that do nothing.
     //
-    SynthesizeBars();
-
-    ApplyGradient( (m_Height)/16, RED);
-    ApplyGradient( (2*m_Height)/16, GREEN);
-    ApplyGradient( (3*m_Height)/16, BLUE);
-    ApplyGradient( (4*m_Height)/16, WHITE);
 
     EncodeNumber((5*m_Height)/16, (UINT32)m_Frame, BLACK, WHITE);
     EncodeNumber((6*m_Height)/16, (UINT32)(m_QpcTime), BLACK, WHITE);
@@ -1172,9 +1378,16 @@ DoCommit(
 {
     PAGED_CODE();
 
+    //  A frame rendered in place is already committed.
+    if( IsRenderTarget( Buffer ) )
+    {
+        m_CommitCount++;
+        return min( Size, m_Length );
+    }
+
     LARGE_INTEGER StartTime = KeQueryPerformanceCounter(NULL);
 
-    ULONG   n = Commit( Buffer, Size, Stride );
+    ULONG   n = CommitFromCache( Buffer, Size, Stride );
 
     m_CommitTime += KeQueryPerformanceCounter(NULL).QuadPart - StartTime.QuadPart;
     m_CommitCount++;
@@ -1200,14 +1413,204 @@ DoCommit(
 {
     PAGED_CODE();
 
-    LARGE_INTEGER StartTime = KeQueryPerformanceCounter(NULL);
+    return DoCommit( Buffer, Size, m_OutputStride );
+}
 
-    ULONG   n = Commit( Buffer, Size );
+BOOLEAN
+CSynthesizer::
+SetRenderTarget(
+    _In_opt_    PUCHAR  Buffer,
+    _In_        ULONG   Size,
+    _In_        ULONG   Stride
+)
+/*++
 
-    m_CommitTime += KeQueryPerformanceCounter(NULL).QuadPart - StartTime.QuadPart;
-    m_CommitCount++;
+Routine Description:
 
-    return n;
+    Select the buffer the next frames are rendered into.  The base class
+    can only render into its scratch buffer, so this just returns to it.
+
+Arguments:
+
+    Buffer -
+        The output frame buffer, or nullptr to render into the scratch
+        buffer.
+
+    Size -
+        The size of the output buffer in bytes.
+
+    Stride -
+        The length of an output row in bytes.
+
+Return Value:
+
+    TRUE if Buffer is the render target.
+
+--*/
+{
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER(Size);
+    UNREFERENCED_PARAMETER(Stride);
+
+    if( m_RenderTarget )
+    {
+        //  The scratch buffer's dirty list was lost; redraw it in full.
+        m_RenderTarget = nullptr;
+        SelectImage( m_ScratchBuffer, m_Width * sizeof(KS_RGBQUAD) );
+    }
+
+    return FALSE;
+}
+
+void
+CSynthesizer::
+FreeFrameCache()
+/*++
+
+Routine Description:
+
+    Release the frame cache.
+
+Arguments:
+
+    none
+
+Return Value:
+
+    void
+
+--*/
+{
+    PAGED_CODE();
+
+    SAFE_DELETE_ARRAY( m_FrameCache );
+    m_FrameCacheSize = 0;
+    m_FrameCacheStride = 0;
+    m_FrameCacheLength = 0;
+    m_FrameCacheDirtyCount = 0;
+}
+
+_Success_(return > 0)
+ULONG
+CSynthesizer::
+CommitFromCache(
+    _Out_writes_bytes_(Size)
+    PUCHAR  Buffer,
+    _In_    ULONG   Size,
+    _In_    ULONG   Stride
+)
+/*++
+
+Routine Description:
+
+    Commit the synthesized frame through the frame cache.
+
+    The first frame for an output size and stride is committed into the
+    cache and copied out.  After that, frames are copied from the cache and
+    only the rows that hold overlays are converted again: the rows this
+    frame's overlays drew on, and those the cached frame's overlays drew
+    on.  Everything else in the image is the base image in both.
+
+Arguments:
+
+    Buffer -
+        The output buffer to fill.
+
+    Size -
+        The size of the output buffer in bytes.
+
+    Stride -
+        The length of a row in bytes.
+
+Return Value:
+
+    Number of bytes copied into Buffer.
+
+--*/
+{
+    PAGED_CODE();
+
+    //
+    //  The dirty list is only complete while the base image is valid.
+    //
+    if( m_FrameCacheDisabled || !m_BaseImageValid )
+    {
+        return Commit( Buffer, Size, Stride );
+    }
+
+    if( !m_FrameCache ||
+        m_FrameCacheSize != Size ||
+        m_FrameCacheStride != Stride )
+    {
+        FreeFrameCache();
+
+        m_FrameCache = new (PagedPool) UCHAR[Size];
+        if( !m_FrameCache )
+        {
+            return Commit( Buffer, Size, Stride );
+        }
+
+        ULONG   n = CommitRows( m_FrameCache, Size, Stride, 0, m_Height );
+        if( !n )
+        {
+            //  This format can only commit whole frames.
+            FreeFrameCache();
+            m_FrameCacheDisabled = TRUE;
+            return Commit( Buffer, Size, Stride );
+        }
+
+        m_FrameCacheSize = Size;
+        m_FrameCacheStride = Stride;
+        m_FrameCacheLength = n;
+        m_FrameCacheDirtyCount = m_DirtyCount;
+        RtlCopyMemory( m_FrameCacheDirtyRects, m_DirtyRects, m_DirtyCount * sizeof(DIRTY_RECT) );
+
+        RtlCopyMemory( Buffer, m_FrameCache, n );
+        return n;
+    }
+
+    RtlCopyMemory( Buffer, m_FrameCache, m_FrameCacheLength );
+
+    //
+    //  Gather the overlay row ranges, sorted by their first row...
+    //
+    ULONG   First[2 * MAX_DIRTY_RECTS];
+    ULONG   End  [2 * MAX_DIRTY_RECTS];
+    ULONG   Count = 0;
+
+    for( ULONG i = 0; i < m_DirtyCount + m_FrameCacheDirtyCount; i++ )
+    {
+        const DIRTY_RECT &Rect =
+            (i < m_DirtyCount) ? m_DirtyRects[i] : m_FrameCacheDirtyRects[i - m_DirtyCount];
+
+        ULONG   j = Count++;
+        for( ; j > 0 && First[j-1] > Rect.LocY; j-- )
+        {
+            First[j] = First[j-1];
+            End[j]   = End[j-1];
+        }
+        First[j] = Rect.LocY;
+        End[j]   = Rect.LocY + Rect.Height;
+    }
+
+    //
+    //  ... and convert each run of overlapping ranges once.
+    //
+    for( ULONG i = 0; i < Count; )
+    {
+        ULONG   RunFirst = First[i];
+        ULONG   RunEnd   = End[i];
+
+        for( i++; i < Count && First[i] <= RunEnd; i++ )
+        {
+            RunEnd = max( RunEnd, End[i] );
+        }
+
+        CommitRows( Buffer, Size, Stride, RunFirst, RunEnd - RunFirst );
+    }
+
+    return m_FrameCacheLength;
 }
 
 #define CLEAR_HISTOGRAM( H )                \
@@ -69,6 +69,14 @@ typedef enum
 //
 #define POSITION_CENTER ((ULONG)-1)
 
+//
+// MAX_DIRTY_RECTS:
+//
+// The number of overlays drawn over the base image that a synthesizer can
+// undo before it has to redraw the whole image.
+//
+#define MAX_DIRTY_RECTS 16
+
 //
 //  Initializer class for a KS_RGBQUAD
 //
@@ -153,6 +161,16 @@ protected:
     ULONG   m_Length;               //  size of the buffer in bytes
     LONG    m_SynthesisStride;      //  size of scan line in bytes
 
+    //
+    //  m_Buffer normally points to the scratch buffer.  When the output
+    //  format is the synthesis format, the image can instead be rendered
+    //  straight into an output frame; see SetRenderTarget().  m_Buffer and
+    //  m_SynthesisStride then describe that frame.  For a bottom-up frame
+    //  m_Buffer points to its last row and the stride is negative.
+    //
+    PUCHAR  m_ScratchBuffer;        //  the scratch buffer we own
+    PUCHAR  m_RenderTarget;         //  output frame being rendered into
+
     //
     //  The assumed stride of our output format.  Currently used by YUY2 and
     //  all image captures, except NV12.  This value should be initialized by
@@ -163,6 +181,53 @@ protected:
     //  Bitmap with a gradient applied for each color in the color pallet.
     CKsRgbQuad *m_GradientBmp;
 
+    //
+    //  Bitmap with one row for each kind of row in the color bars: the bars
+    //  alone, and the bars with the top or bottom registration boxes.  The
+    //  base image is built by copying these and the gradient rows.
+    //
+    enum
+    {
+        BAR_ROW_BARS = 0,
+        BAR_ROW_TOP,
+        BAR_ROW_BOTTOM,
+        BAR_ROW_COUNT
+    };
+    CKsRgbQuad *m_BarRowBmp;
+
+    //
+    //  The base image (bars and gradients) is the same for every frame.
+    //  Once drawn, only the areas that overlays have changed since are
+    //  restored from it, instead of redrawing the whole image.
+    //
+    typedef struct
+    {
+        ULONG   LocX;
+        ULONG   LocY;
+        ULONG   Width;
+        ULONG   Height;
+    } DIRTY_RECT;
+
+    BOOLEAN     m_BaseImageValid;
+    ULONG       m_DirtyCount;
+    DIRTY_RECT  m_DirtyRects[MAX_DIRTY_RECTS];
+
+    //
+    //  The frame cache:
+    //
+    //  A frame committed in the output format, for one output size and
+    //  stride.  Later frames are copied from it, and only the rows that
+    //  hold overlays - this frame's, or those that were in the cached
+    //  frame - are converted again.
+    //
+    PUCHAR      m_FrameCache;
+    ULONG       m_FrameCacheSize;       //  output size it was committed for
+    ULONG       m_FrameCacheStride;     //  output stride it was committed for
+    ULONG       m_FrameCacheLength;     //  bytes Commit returned
+    ULONG       m_FrameCacheDirtyCount;
+    DIRTY_RECT  m_FrameCacheDirtyRects[MAX_DIRTY_RECTS];
+    BOOLEAN     m_FrameCacheDisabled;   //  the format has no CommitRows
+
     //
     // The default cursor.  This is a pointer into the synthesis buffer where
     // a non specific PutPixel will be placed.
@@ -214,8 +279,19 @@ public:
         : m_Width(Width)
         , m_Height(Height)
         , m_Buffer(nullptr)
+        , m_ScratchBuffer(nullptr)
+        , m_RenderTarget(nullptr)
         , m_Cursor(nullptr)
         , m_GradientBmp(nullptr)
+        , m_BarRowBmp(nullptr)
+        , m_BaseImageValid(FALSE)
+        , m_DirtyCount(0)
+        , m_FrameCache(nullptr)
+        , m_FrameCacheSize(0)
+        , m_FrameCacheStride(0)
+        , m_FrameCacheLength(0)
+        , m_FrameCacheDirtyCount(0)
+        , m_FrameCacheDisabled(FALSE)
         , m_SynthesisStride(m_Width * sizeof(KS_RGBQUAD))
         , m_OutputStride(0)
         , m_FormatName(Name)
@@ -363,6 +439,67 @@ public:
         return Commit( Buffer, Size, m_OutputStride );
     }
 
+    //
+    //  CommitRows
+    //
+    //  Like Commit, but only convert the output rows that come from rows
+    //  LocY to LocY+Height-1 of the synthesis buffer, and leave the rest of
+    //  Buffer as it is.  Returns what Commit would, or 0 if the format
+    //  can't commit part of an image; the frame cache is not used then.
+    //
+    virtual
+    _Success_(return > 0)
+    ULONG
+    CommitRows(
+        _Out_writes_bytes_(Size)
+        PUCHAR  Buffer,
+        _In_    ULONG   Size,
+        _In_    ULONG   Stride,
+        _In_    ULONG   LocY,
+        _In_    ULONG   Height
+    )
+    {
+        UNREFERENCED_PARAMETER(Buffer);
+        UNREFERENCED_PARAMETER(Size);
+        UNREFERENCED_PARAMETER(Stride);
+        UNREFERENCED_PARAMETER(LocY);
+        UNREFERENCED_PARAMETER(Height);
+
+        return 0;
+    }
+
+    //
+    //  SetRenderTarget
+    //
+    //  Render the next frames straight into an output frame buffer instead
+    //  of the scratch buffer, so committing that buffer needs no copy.  The
+    //  target must be set before the frame is synthesized and overlaid, and
+    //  released (Buffer == nullptr) before the output buffer is released.
+    //
+    //  Returns TRUE if Buffer is now the target.  Only formats whose output
+    //  pixels are the synthesis pixels can accept one.
+    //
+    virtual
+    BOOLEAN
+    SetRenderTarget(
+        _In_opt_    PUCHAR  Buffer,
+        _In_        ULONG   Size,
+        _In_        ULONG   Stride
+    );
+
+    //
+    //  IsRenderTarget
+    //
+    //  Is the image being rendered straight into this output buffer?
+    //
+    BOOLEAN
+    IsRenderTarget(
+        _In_opt_    PUCHAR  Buffer
+    )
+    {
+        return Buffer != nullptr && Buffer == m_RenderTarget;
+    }
+
     //
     //  Histogram
     //
@@ -485,6 +622,113 @@ protected:
         return nullptr;
     }
 
+    //
+    //  GetPixel
+    //
+    //  Get the synthesis buffer pixel for a palette color.
+    //
+    KS_RGBQUAD
+    GetPixel(
+        _In_    COLOR Color
+    )
+    {
+        return CKsRgbQuad( m_Colors[Color][2], m_Colors[Color][1], m_Colors[Color][0] );
+    }
+
+    //
+    //  FillPixels
+    //
+    //  Place a run of pixels of one color at the default cursor location
+    //  and advance the cursor past it.
+    //
+    void
+    FillPixels(
+        _In_    ULONG Count,
+        _In_    COLOR Color
+    );
+
+    //
+    //  BuildBarRows
+    //
+    //  Render the color bar rows into m_BarRowBmp.
+    //
+    void
+    BuildBarRows();
+
+    //
+    //  GetBarRow / GetBaseRow
+    //
+    //  Get the row of m_BarRowBmp or m_GradientBmp that row LocY of the
+    //  color bars or of the base image is a copy of.
+    //
+    const KS_RGBQUAD *
+    GetBarRow(
+        _In_    ULONG LocY
+    );
+
+    const KS_RGBQUAD *
+    GetBaseRow(
+        _In_    ULONG LocY
+    );
+
+    //
+    //  AddDirtyRect
+    //
+    //  Note an area of the image that no longer holds the base image.
+    //
+    void
+    AddDirtyRect(
+        _In_    ULONG LocX,
+        _In_    ULONG LocY,
+        _In_    ULONG Width,
+        _In_    ULONG Height
+    );
+
+    //
+    //  RestoreDirtyRects
+    //
+    //  Copy the base image back over every dirty area.
+    //
+    void
+    RestoreDirtyRects();
+
+    //
+    //  CommitFromCache
+    //
+    //  Commit through the frame cache, filling it first if needed.
+    //
+    _Success_(return > 0)
+    ULONG
+    CommitFromCache(
+        _Out_writes_bytes_(Size)
+        PUCHAR  Buffer,
+        _In_    ULONG   Size,
+        _In_    ULONG   Stride
+    );
+
+    //
+    //  FreeFrameCache
+    //
+    void
+    FreeFrameCache();
+
+    //
+    //  SelectImage
+    //
+    //  Point the image at a buffer.  The base image has to be redrawn.
+    //
+    void
+    SelectImage(
+        _In_    PUCHAR  Origin,
+        _In_    LONG    Stride
+    )
+    {
+        m_Buffer = Origin;
+        m_SynthesisStride = Stride;
+        m_BaseImageValid = FALSE;
+        m_DirtyCount = 0;
+    }
+
     //
     // GetImageLocation
     //
@@ -500,7 +744,7 @@ protected:
     {
         return
             m_Cursor =
-                (m_Buffer + (sizeof(CKsRgbQuad) * LocX) + (LocY * m_SynthesisStride));
+                (m_Buffer + (sizeof(CKsRgbQuad) * LocX) + ((LONG_PTR) LocY * m_SynthesisStride));
     }
 
 };
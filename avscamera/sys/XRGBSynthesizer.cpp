@@ -133,6 +133,78 @@ Return Value:
 // suppressed due to Esp:773
 #pragma warning (pop)
 
+BOOLEAN
+CXRGBSynthesizer::
+SetRenderTarget(
+    _In_opt_    PUCHAR  Buffer,
+    _In_        ULONG   Size,
+    _In_        ULONG   Stride
+)
+/*++
+
+Routine Description:
+
+    Select the buffer the next frames are rendered into.  An RGB32 frame
+    can be rendered into directly if its rows are exactly as long as ours
+    and it holds the whole image.  A bottom-up frame is rendered with a
+    negative stride from its last row.
+
+Arguments:
+
+    Buffer -
+        The output frame buffer, or nullptr to render into the scratch
+        buffer.
+
+    Size -
+        The size of the output buffer in bytes.
+
+    Stride -
+        The length of an output row in bytes.
+
+Return Value:
+
+    TRUE if Buffer is the render target.
+
+--*/
+{
+    PAGED_CODE();
+
+    //  In case stride isn't initialized.
+    if( Stride==0 )
+    {
+        Stride = m_OutputStride;
+    }
+
+    //  m_OutputStride tells us whether the output pixels are ours too; a
+    //  derived RGB24 synthesizer's are not.
+    if( !(  Buffer &&
+            m_ScratchBuffer &&
+            (ULONG) m_OutputStride == m_Width * sizeof(KS_RGBQUAD) &&
+            Stride == m_Width * sizeof(KS_RGBQUAD) &&
+            Size >= m_Length &&
+            ((ULONG_PTR) Buffer & 3) == 0
+         ) )
+    {
+        return CSynthesizer::SetRenderTarget( nullptr, 0, 0 );
+    }
+
+    //
+    //  Whatever the buffer held before, it doesn't hold our base image now.
+    //  SelectImage() makes the next Synthesize() draw all of it.
+    //
+    m_RenderTarget = Buffer;
+    if( m_FlipVertical )
+    {
+        SelectImage( Buffer + ((m_Height - 1) * Stride), -((LONG) Stride) );
+    }
+    else
+    {
+        SelectImage( Buffer, (LONG) Stride );
+    }
+
+    return TRUE;
+}
+
 const UCHAR4 *
 CXRGBSynthesizer::
 GetPalette()
@@ -83,6 +83,19 @@ public:
     BOOLEAN
     Initialize();
 
+    //
+    //  SetRenderTarget
+    //
+    //  Render straight into an RGB32 frame with our row length.
+    //
+    virtual
+    BOOLEAN
+    SetRenderTarget(
+        _In_opt_    PUCHAR  Buffer,
+        _In_        ULONG   Size,
+        _In_        ULONG   Stride
+    );
+
 protected:
     //
     //  GetPalette
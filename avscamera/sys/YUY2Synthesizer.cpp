@@ -49,11 +49,13 @@
 _Success_(return > 0)
 ULONG
 CYUY2Synthesizer::
-Commit(
+CommitRows(
     _Out_writes_bytes_(Size)
     PUCHAR  Buffer,
     _In_    ULONG   Size,
-    _In_    ULONG   Stride
+    _In_    ULONG   Stride,
+    _In_    ULONG   LocY,
+    _In_    ULONG   Height
 )
 /*++
 
@@ -62,6 +64,9 @@ Routine Description:
     Copy (and reformat, if necessary) pixels from the internal scratch
     buffer.  If the output format decimates chrominance, do it here.
 
+    Only the output rows that come from rows LocY to LocY+Height-1 of the
+    scratch buffer are written.
+
 Arguments:
 
     Buffer -
@@ -73,9 +78,15 @@ Arguments:
     Stride -
         The length of a row in bytes.
 
+    LocY -
+        The first scratch buffer row to convert.
+
+    Height -
+        The number of scratch buffer rows to convert.
+
 Return Value:
 
-    Number of bytes copied into Buffer.
+    Number of bytes a full commit copies into Buffer.
 
 --*/
 {
@@ -111,24 +122,15 @@ Return Value:
         return 0;
     }
 
-    PKS_RGBQUAD pSrc = (PKS_RGBQUAD) m_Buffer;
     ULONG   RowLimit = min( m_Height, Size / Stride );
     ULONG   ColLimit = min( m_Width,  Stride/sizeof(WORD) ) & ~0x1;
+    ULONG   RowEnd   = min( RowLimit, LocY + Height );
 
-    for(ULONG row = 0; row < RowLimit; row++)
+    for(ULONG row = LocY; row < RowEnd; row++)
     {
-        PDWORD  pY  = (PDWORD) &Buffer[ row * Stride ];
-
-        for(ULONG col = 0; col < ColLimit; col+=2)
-        {
-            KS_RGBQUAD  L = pSrc[col+0];
-            KS_RGBQUAD  R = pSrc[col+1];
-
-            *pY++ =
-                MAKELONG( MAKEWORD( L.rgbGreen, (ULONG(L.rgbBlue) + R.rgbBlue)/2),
-                          MAKEWORD( R.rgbGreen, (ULONG(L.rgbRed ) + R.rgbRed )/2) );
-        }
-        pSrc = (PKS_RGBQUAD) (((PUCHAR) pSrc) + m_SynthesisStride);
+        PKS_RGBQUAD pSrc = (PKS_RGBQUAD) GetImageLocation( 0, row );
+
+        ConvertRowToYUY2( (PDWORD) &Buffer[ row * Stride ], pSrc, ColLimit/2 );
     }
 
     return RowLimit * Stride;
@@ -61,6 +61,26 @@ public:
         PUCHAR  Buffer,
         _In_    ULONG   Size,
         _In_    ULONG   Stride
+    )
+    {
+        return CommitRows( Buffer, Size, Stride, 0, m_Height );
+    }
+
+    //
+    //  CommitRows
+    //
+    //  Convert only the rows LocY to LocY+Height-1 of the scratch buffer.
+    //
+    virtual
+    _Success_(return > 0)
+    ULONG
+    CommitRows(
+        _Out_writes_bytes_(Size)
+        PUCHAR  Buffer,
+        _In_    ULONG   Size,
+        _In_    ULONG   Stride,
+        _In_    ULONG   LocY,
+        _In_    ULONG   Height
     );
 
 };
@@ -122,6 +122,10 @@ CHardwareSimulation (
     , m_LastReportedExposureTime(DEF_EXPOSURE_TIME) // Assume the default exposure time for now.
     , m_LastReportedWhiteBalance(0)
     , m_FaceDetectionDelay(1)                       // Start out reporting immediately.
+    , m_RenderDirect(TRUE)
+    , m_LastFrameDirect(FALSE)
+    , m_InterruptQpc(0)
+    , m_SynthesizedQpc(0)
 
 /*++
 
@@ -1027,9 +1031,10 @@ Return Value:
                 )
             );
 
-        //  Deal with cancellation.
+        //  Deal with cancellation.  A frame already rendered into its
+        //  buffer is delivered anyway; the synthesizer has nothing else.
         PIRP pIrp = KsStreamPointerGetIrp(SGEntry->CloneEntry, FALSE, FALSE);
-        if (pIrp)
+        if (pIrp && !m_Synthesizer->IsRenderTarget(SGEntry->Virtual))
         {
             if (pIrp->Cancel)
             {
@@ -1042,19 +1047,15 @@ Return Value:
         //
         // Since we're software, we'll be accessing this by virtual address...
         //
-        ULONG Stride = 0;
-        if ( SGEntry->CloneEntry -> StreamHeader -> Size >= sizeof (KSSTREAM_HEADER) +
-                sizeof (KS_FRAME_INFO))
-        {
-            PKS_FRAME_INFO FrameInfo = reinterpret_cast <PKS_FRAME_INFO> (SGEntry->CloneEntry->StreamHeader+1);
-            Stride = (ULONG) ABS(FrameInfo->lSurfacePitch);
-        }
+        ULONG Stride = GetFrameStride( SGEntry );
 
         //  Have the synthesizer output a frame to the buffer.
         ULONG   BytesCopied = m_Synthesizer->DoCommit( SGEntry->Virtual, SGEntry->ByteCount, Stride );
         NT_ASSERT( BytesCopied );
         DBG_TRACE( "BytesCopied = %d", BytesCopied );
 
+        StampFrame( SGEntry->CloneEntry );
+
         //Adding time stamp
         if(m_PhotoConfirmationEntry.isRequired())
         {
@@ -1137,6 +1138,110 @@ OIS_Text( ULONGLONG Flags )
 
 /**************************************************************************/
 
+ULONG
+CHardwareSimulation::
+GetFrameStride(
+    _In_    PSCATTER_GATHER_ENTRY SGEntry
+)
+/*++
+
+Routine Description:
+
+    Get the row pitch of a frame buffer from its KS_FRAME_INFO, if it has
+    one.
+
+Arguments:
+
+    SGEntry -
+        The frame buffer's queue entry.
+
+Return Value:
+
+    The pitch in bytes, or 0 if the stream header doesn't say.
+
+--*/
+{
+    PAGED_CODE();
+
+    ULONG Stride = 0;
+    if ( SGEntry->CloneEntry -> StreamHeader -> Size >= sizeof (KSSTREAM_HEADER) +
+            sizeof (KS_FRAME_INFO))
+    {
+        PKS_FRAME_INFO FrameInfo = reinterpret_cast <PKS_FRAME_INFO> (SGEntry->CloneEntry->StreamHeader+1);
+        Stride = (ULONG) ABS(FrameInfo->lSurfacePitch);
+    }
+    return Stride;
+}
+
+void
+CHardwareSimulation::
+StampFrame(
+    _In_    PKSSTREAM_POINTER Clone
+)
+/*++
+
+Routine Description:
+
+    Record when the current frame's interrupt fired, when its synthesis
+    finished and, now, when it was committed to the frame buffer.
+
+Arguments:
+
+    Clone -
+        The stream pointer of the frame buffer.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PAGED_CODE();
+
+    PSTREAM_POINTER_CONTEXT SPContext =
+        reinterpret_cast <PSTREAM_POINTER_CONTEXT> (Clone->Context);
+
+    SPContext->Timing.Interrupt = m_InterruptQpc;
+    SPContext->Timing.Synthesized = m_SynthesizedQpc;
+    SPContext->Timing.Filled = CFrameTimingLog::Now();
+}
+
+void
+CHardwareSimulation::
+SynthesizeFrame()
+/*++
+
+Routine Description:
+
+    Synthesize the current frame, with the sensor state overlays, into
+    the synthesizer's render target.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+{
+    PAGED_CODE();
+
+    m_Synthesizer->DoSynthesize();
+
+    CHAR Text[64];
+
+    CExtendedProperty   Control;
+    m_Sensor->GetVideoStabilization( &Control );
+    RtlStringCbPrintfA(Text, sizeof(Text), "DVS: %s", DVS_Text(Control.Flags));
+    m_Synthesizer->OverlayText( 0, m_Height-38, 1, Text, BLACK, WHITE );
+
+    m_Sensor->GetOpticalImageStabilization( &Control );
+    RtlStringCbPrintfA(Text, sizeof(Text), "OIS: %s", OIS_Text(Control.Flags));
+    m_Synthesizer->OverlayText( 0, m_Height-48, 1, Text, BLACK, WHITE );
+}
+
 void
 CHardwareSimulation::
 FakeHardware (
@@ -1162,9 +1267,12 @@ Return Value:
 {
     PAGED_CODE();
 
+    LONGLONG InterruptQpc = CFrameTimingLog::Now();
+
     KScopedMutex Lock( m_ListLock );
 
     m_InterruptTime++;
+    m_InterruptQpc = InterruptQpc;
 
     //
     // The hardware can be in a pause state in which case, it issues interrupts
@@ -1184,18 +1292,29 @@ Return Value:
         m_Synthesizer->SetRelativePts( (m_InterruptTime + 1) * m_TimePerFrame );
         m_Synthesizer->SetQpcTime( time );
 
-        m_Synthesizer->DoSynthesize();
-
-        CHAR Text[64];
+        //
+        // If a frame buffer is waiting, try to render straight into the one
+        // FillScatterGatherBuffers will complete.  That saves copying the
+        // whole frame out of the synthesis buffer.
+        //
+        m_LastFrameDirect = FALSE;
+        if (m_RenderDirect &&
+                !IsListEmpty(&m_ScatterGatherMappings) &&
+                m_ScatterGatherBytesQueued >= m_ImageSize)
+        {
+            PSCATTER_GATHER_ENTRY SGEntry =
+                CONTAINING_RECORD (
+                    m_ScatterGatherMappings.Flink,
+                    SCATTER_GATHER_ENTRY,
+                    ListEntry
+                );
 
-        CExtendedProperty   Control;
-        m_Sensor->GetVideoStabilization( &Control );
-        RtlStringCbPrintfA(Text, sizeof(Text), "DVS: %s", DVS_Text(Control.Flags));
-        m_Synthesizer->OverlayText( 0, m_Height-38, 1, Text, BLACK, WHITE );
+            m_LastFrameDirect =
+                m_Synthesizer->SetRenderTarget( SGEntry->Virtual, SGEntry->ByteCount, GetFrameStride( SGEntry ) );
+        }
 
-        m_Sensor->GetOpticalImageStabilization( &Control );
-        RtlStringCbPrintfA(Text, sizeof(Text), "OIS: %s", OIS_Text(Control.Flags));
-        m_Synthesizer->OverlayText( 0, m_Height-48, 1, Text, BLACK, WHITE );
+        SynthesizeFrame();
+        m_SynthesizedQpc = CFrameTimingLog::Now();
 
         //
         // Fill scatter gather buffers
@@ -1205,6 +1324,11 @@ Return Value:
             InterlockedIncrement (PLONG (&m_NumFramesSkipped));
         }
 
+        //
+        // The frame buffer belongs to the sensor now.
+        //
+        m_Synthesizer->SetRenderTarget( nullptr, 0, 0 );
+
     }
 
     //
@@ -1312,6 +1436,20 @@ Return Value:
 
     m_PhotoConfirmationEntry = PHOTOCONFIRMATION_INFO( PfsFrameNumber, time );
 
+    //  The confirmation reuses the last preview image, so it has no
+    //  synthesis time of its own unless the image has to be rendered again.
+    m_InterruptQpc = CFrameTimingLog::Now();
+    m_SynthesizedQpc = m_InterruptQpc;
+
+    //  If the previous preview image went straight into its frame buffer,
+    //  render it again into the synthesis buffer.
+    if( m_LastFrameDirect )
+    {
+        SynthesizeFrame();
+        m_SynthesizedQpc = CFrameTimingLog::Now();
+        m_LastFrameDirect = FALSE;
+    }
+
     // We basically used the previously synthesized preview image
     NTSTATUS status = FillScatterGatherBuffers();
 
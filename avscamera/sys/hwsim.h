@@ -133,6 +133,33 @@ protected:
     ULONG       m_FaceDetectionDelay;
     CAMERA_METADATA_FACE_DETECTION  m_LastFaceDetect;
 
+    //  Render frames straight into the next frame buffer, when the format
+    //  allows it, instead of copying them from the synthesis buffer.
+    BOOLEAN     m_RenderDirect;
+
+    //  The last frame was rendered into a frame buffer that is now gone.
+    BOOLEAN     m_LastFrameDirect;
+
+    //  When the current frame's interrupt fired and its synthesis finished.
+    LONGLONG    m_InterruptQpc;
+    LONGLONG    m_SynthesizedQpc;
+
+    //  Synthesize a frame and its overlays.
+    void
+    SynthesizeFrame();
+
+    //  Record the current frame's stage times in its frame buffer.
+    void
+    StampFrame(
+        _In_    PKSSTREAM_POINTER Clone
+    );
+
+    //  The row pitch of a frame buffer, or 0 for the format's default.
+    ULONG
+    GetFrameStride(
+        _In_    PSCATTER_GATHER_ENTRY SGEntry
+    );
+
     //  Copy a synthesized framebuffer.
     virtual
     NTSTATUS
@@ -756,6 +756,8 @@ Return Value:
         NT_ASSERT(BytesCopied);
         DBG_TRACE( "BytesCopied = %d", BytesCopied );
 
+        StampFrame( SGEntry->CloneEntry );
+
         BufferRemaining = 0; //-= BytesCopied;
 
         //  Add metadata to the sample.
@@ -867,10 +869,13 @@ Return Value:
 {
     PAGED_CODE();
 
+    LONGLONG InterruptQpc = CFrameTimingLog::Now();
+
     //  Prevent state-changes during this call.
     KScopedMutex    Lock(m_ListLock);
 
     m_InterruptTime++;
+    m_InterruptQpc = InterruptQpc;
 
     //
     // The hardware can be in a pause state in which case, it issues interrupts
@@ -885,6 +890,7 @@ Return Value:
         }
 
         m_Synthesizer->DoSynthesize();
+        m_SynthesizedQpc = CFrameTimingLog::Now();
 
         //
         // Fill scatter gather buffers
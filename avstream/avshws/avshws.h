@@ -106,6 +106,22 @@ const DebugLevel = DEBUGLVL_TERSE;
 
 #define AVSHWS_POOLTAG 'hSVA'
 
+//
+// AVSHWS_FRAMES_IN_FLIGHT:
+//
+// The number of frame buffers the capture pin asks for and can queue to
+// the simulated hardware at once.  A deeper queue rides out late buffer
+// returns at high frame rates.
+//
+#define AVSHWS_FRAMES_IN_FLIGHT 8
+
+//
+// AVSHWS_MIN_FRAME_INTERVAL:
+//
+// The shortest frame time the capture pin supports; 240fps.
+//
+#define AVSHWS_MIN_FRAME_INTERVAL 41667
+
 /*************************************************
 
     Externed information
@@ -195,7 +195,7 @@ Return Value:
                         Pin -> Descriptor -> AllocatorFraming
                         );
 
-                Framing -> FramingItem [0].Frames = 2;
+                Framing -> FramingItem [0].Frames = AVSHWS_FRAMES_IN_FLIGHT;
 
                 //
                 // The physical and optimal ranges must be biSizeImage.  We only
@@ -1543,10 +1543,10 @@ FormatRGB24Bpp_Capture = {
         0,              // StretchTapsY
         0,              // ShrinkTapsX 
         0,              // ShrinkTapsY 
-        333667,         // MinFrameInterval, 100 nS units
+        AVSHWS_MIN_FRAME_INTERVAL,  // MinFrameInterval, 100 nS units
         640000000,      // MaxFrameInterval, 100 nS units
         8 * 3 * 30 * D_X * D_Y,  // MinBitsPerSecond;
-        8 * 3 * 30 * D_X * D_Y   // MaxBitsPerSecond;
+        8 * 3 * 240 * D_X * D_Y  // MaxBitsPerSecond;
     }, 
         
     //
@@ -1623,10 +1623,10 @@ FormatYUY2_Capture = {
         0,              // StretchTapsY
         0,              // ShrinkTapsX 
         0,              // ShrinkTapsY 
-        333667,         // MinFrameInterval, 100 nS units
+        AVSHWS_MIN_FRAME_INTERVAL,  // MinFrameInterval, 100 nS units
         640000000,      // MaxFrameInterval, 100 nS units
         8 * 2 * 30 * D_X * D_Y,  // MinBitsPerSecond;
-        8 * 2 * 30 * DMAX_X * DMAX_Y,   // MaxBitsPerSecond;
+        8 * 2 * 240 * DMAX_X * DMAX_Y,  // MaxBitsPerSecond;
     }, 
         
     //
@@ -1684,7 +1684,7 @@ DECLARE_SIMPLE_FRAMING_EX (
     STATICGUIDOF (KSMEMORY_TYPE_KERNEL_NONPAGED),
     KSALLOCATOR_REQUIREMENTF_SYSTEM_MEMORY |
         KSALLOCATOR_REQUIREMENTF_PREFERENCES_ONLY,
-    2,
+    AVSHWS_FRAMES_IN_FLIGHT,
     0,
     2 * PAGE_SIZE,
     2 * PAGE_SIZE
@@ -26,17 +26,17 @@
 
 
 /*************************************************/
-KDEFERRED_ROUTINE SimulatedInterrupt;
+EXT_CALLBACK SimulatedInterrupt;
 
 void
 SimulatedInterrupt (
-    IN PKDPC Dpc,
-    IN PVOID DeferredContext,
-    IN PVOID SystemArg1,
-    IN PVOID SystemArg2
+    IN PEX_TIMER Timer,
+    IN PVOID Context
     )
 {
-    CHardwareSimulation* HardwareSim = (CHardwareSimulation*)DeferredContext;
+    UNREFERENCED_PARAMETER (Timer);
+
+    CHardwareSimulation* HardwareSim = (CHardwareSimulation*)Context;
     
     if (HardwareSim)
     {
@@ -61,8 +61,7 @@ CHardwareSimulation::
 CHardwareSimulation (
     IN IHardwareSink *HardwareSink
     ) :
-    m_HardwareSink (HardwareSink),
-    m_ScatterGatherMappingsMax (SCATTER_GATHER_MAPPINGS_MAX)
+    m_HardwareSink (HardwareSink)
 
 /*++
 
@@ -87,24 +86,49 @@ Return Value:
     PAGED_CODE();
 
     //
-    // Initialize the DPC's, timer's, and locks necessary to simulate
-    // this capture hardware.
+    // Initialize the events necessary to simulate this capture hardware.
+    // The interrupt timer is allocated on the first start.
     //
-    KeInitializeDpc (
-        &m_IsrFakeDpc, 
-        SimulatedInterrupt, 
-        this
-        );
-
     KeInitializeEvent (
         &m_HardwareEvent,
         SynchronizationEvent,
         FALSE
         );
 
-    KeInitializeTimer (&m_IsrTimer);
+}
+
+/*************************************************/
+
+
+CHardwareSimulation::
+~CHardwareSimulation (
+    )
+
+/*++
+
+Routine Description:
+
+    Destroy a hardware simulation.  The hardware has been stopped, so the
+    timer is idle; deleting it waits out any callback still running.
 
-    KeInitializeSpinLock (&m_ListLock);
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+
+{
+
+    PAGED_CODE();
+
+    if (m_IsrTimer) {
+        ExDeleteTimer (m_IsrTimer, TRUE, TRUE, NULL);
+        m_IsrTimer = NULL;
+    }
 
 }
 
@@ -207,27 +231,45 @@ Return Value:
     m_Height = Height;
     m_Width = Width;
 
-    InitializeListHead (&m_ScatterGatherMappings);
+    m_ScatterGatherHead = 0;
+    m_ScatterGatherTail = 0;
+    m_ScatterGatherBytesQueued = 0;
     m_NumMappingsCompleted = 0;
-    m_ScatterGatherMappingsQueued = 0;
     m_NumFramesSkipped = 0;
     m_InterruptTime = 0;
 
-    KeQuerySystemTime (&m_StartTime);
+    //
+    // A high resolution timer follows the frame time closely even at high
+    // frame rates, where the default timer resolution would make frames
+    // arrive in bursts.
+    //
+    if (!m_IsrTimer) {
+        m_IsrTimer = ExAllocateTimer (
+            SimulatedInterrupt,
+            this,
+            EX_TIMER_HIGH_RESOLUTION
+            );
+
+        if (!m_IsrTimer) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
 
     //
     // Allocate a scratch buffer for the synthesizer.
     //
-    m_SynthesisBuffer = reinterpret_cast <PUCHAR> (
-        ExAllocatePoolWithTag (
-            NonPagedPoolNx,
-            m_ImageSize,
-            AVSHWS_POOLTAG
-            )
-        );
+    if (NT_SUCCESS (Status)) {
+        m_SynthesisBuffer = reinterpret_cast <PUCHAR> (
+            ExAllocatePoolWithTag (
+                NonPagedPoolNx,
+                m_ImageSize,
+                AVSHWS_POOLTAG
+                )
+            );
 
-    if (!m_SynthesisBuffer) {
-        Status = STATUS_INSUFFICIENT_RESOURCES;
+        if (!m_SynthesisBuffer) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+        }
     }
 
     //
@@ -235,30 +277,16 @@ Return Value:
     //
     if (NT_SUCCESS (Status)) {
 
-        //
-        // Initialize the entry lookaside.
-        //
-        ExInitializeNPagedLookasideList (
-            &m_ScatterGatherLookaside,
-            NULL,
-            NULL,
-            POOL_NX_ALLOCATION,
-            sizeof (SCATTER_GATHER_ENTRY),
-            'nEGS',
-            0
-            );
-
         //
         // Set up the synthesizer with the width, height, and scratch buffer.
         //
         m_ImageSynth -> SetImageSize (m_Width, m_Height);
         m_ImageSynth -> SetBuffer (m_SynthesisBuffer);
 
-        LARGE_INTEGER NextTime;
-        NextTime.QuadPart = m_StartTime.QuadPart + m_TimePerFrame;
+        m_StartTime.QuadPart = KeQueryInterruptTimePrecise (NULL);
 
         m_HardwareState = HardwareRunning;
-        KeSetTimer (&m_IsrTimer, NextTime, &m_IsrFakeDpc);
+        ScheduleInterrupt ();
 
     }
 
@@ -329,19 +357,15 @@ Return Value:
         // For unpausing the hardware, we need to compute the relative time
         // and restart interrupts.
         //
-        LARGE_INTEGER UnpauseTime;
+        LONGLONG UnpauseTime = KeQueryInterruptTimePrecise (NULL);
 
-        KeQuerySystemTime (&UnpauseTime);
         m_InterruptTime = (ULONG) (
-            (UnpauseTime.QuadPart - m_StartTime.QuadPart) /
+            (UnpauseTime - m_StartTime.QuadPart) /
             m_TimePerFrame
             );
 
-        UnpauseTime.QuadPart = m_StartTime.QuadPart +
-            (m_InterruptTime + 1) * m_TimePerFrame;
-
         m_HardwareState = HardwareRunning;
-        KeSetTimer (&m_IsrTimer, UnpauseTime, &m_IsrFakeDpc);
+        ScheduleInterrupt ();
 
     }
 
@@ -382,7 +406,6 @@ Return Value:
 --*/
 
 {
-    KIRQL Irql;
     //
     // If the hardware is told to stop while it's running, we need to
     // halt the interrupts first.  If we're already paused, this has
@@ -418,41 +441,16 @@ Return Value:
     }
 
     //
-    // Protect the S/G list
-    //
-    KeAcquireSpinLock (&m_ListLock, &Irql);
-    // 
-    // Free S/G buffer 
-    // 
-    // 
-    while (m_ScatterGatherMappingsQueued > 0) {
-        LIST_ENTRY *listEntry = RemoveHeadList (&m_ScatterGatherMappings);
-        m_ScatterGatherMappingsQueued--;
-        PSCATTER_GATHER_ENTRY SGEntry =
-            reinterpret_cast <PSCATTER_GATHER_ENTRY> (
-                CONTAINING_RECORD (
-                    listEntry,
-                    SCATTER_GATHER_ENTRY,
-                    ListEntry
-                    )
-                );
-        // 
-        // Release the scatter / gather entry back to our lookaside. 
-        // 
-        ExFreeToNPagedLookasideList (
-            &m_ScatterGatherLookaside,
-            reinterpret_cast <PVOID> (SGEntry)
-            );
-    } 
-
-    m_NumMappingsCompleted = 0;
-    m_ScatterGatherBytesQueued = 0;
-    //
-    // Delete the scatter / gather lookaside for this run.
+    // The interrupts have stopped, so we are the consumer of the S/G
+    // table now.  Drop whatever is queued; the pin releases the frames.
     //
-    ExDeleteNPagedLookasideList (&m_ScatterGatherLookaside);
+    WriteRelease (
+        &m_ScatterGatherHead,
+        ReadAcquire (&m_ScatterGatherTail)
+        );
 
-    KeReleaseSpinLock (&m_ListLock, Irql);
+    m_NumMappingsCompleted = 0;
+    InterlockedExchange (&m_ScatterGatherBytesQueued, 0);
 
     return STATUS_SUCCESS;
 
@@ -538,37 +536,30 @@ Return Value:
 
 {
 
-    KIRQL Irql;
-
     ULONG MappingsInserted = 0;
 
     //
-    // Protect our S/G list with a spinlock.
+    // We are the only writer of the tail.  The head may move on while we
+    // look at it, which only frees more room.
     //
-    KeAcquireSpinLock (&m_ListLock, &Irql);
+    ULONG Tail = (ULONG) m_ScatterGatherTail;
+    ULONG Head = (ULONG) ReadAcquire (&m_ScatterGatherHead);
 
     //
     // Loop through the scatter / gather list and break the buffer up into
     // chunks equal to the scatter / gather mappings.  Stuff the virtual
-    // addresses of these chunks on a list somewhere.  We update the buffer
+    // addresses of these chunks in the table.  We update the buffer
     // pointer the caller passes as a more convenient way of doing this.
     //
     // If I could just remap physical in the list to virtual easily here,
     // I wouldn't need to do it.
     //
 #if !defined(_X86_)
-    do
-    {
+    if (Tail - Head < SCATTER_GATHER_MAPPINGS_MAX) {
+
         PSCATTER_GATHER_ENTRY Entry =
-            reinterpret_cast <PSCATTER_GATHER_ENTRY> (
-                ExAllocateFromNPagedLookasideList (
-                    &m_ScatterGatherLookaside
-                    )
-                );
-
-        if (!Entry) {
-            break;
-        }
+            &m_ScatterGatherMappings [Tail & (SCATTER_GATHER_MAPPINGS_MAX - 1)];
+
         Entry -> Virtual    = *Buffer;
         Entry -> ByteCount  = MappingsCount;
         Entry -> CloneEntry = Clone;
@@ -578,37 +569,25 @@ Return Value:
         // mapping sized va buffers.
         //
         *Buffer += MappingsCount;
-        Mappings = reinterpret_cast <PKSMAPPING> (
-            (reinterpret_cast <PUCHAR> (Mappings) + MappingStride)
-            );
 
-        InsertTailList (&m_ScatterGatherMappings, &(Entry -> ListEntry));
+        Tail++;
         MappingsInserted = MappingsCount;
-        m_ScatterGatherMappingsQueued++;
-        m_ScatterGatherBytesQueued += MappingsCount;
+        InterlockedExchangeAdd (&m_ScatterGatherBytesQueued, MappingsCount);
 
-   }
-    while(FALSE);
+    }
 
 #else 
-	for (ULONG MappingNum = 0; 
+    for (ULONG MappingNum = 0; 
         MappingNum < MappingsCount &&
-            m_ScatterGatherMappingsQueued < m_ScatterGatherMappingsMax; 
+            Tail - Head < SCATTER_GATHER_MAPPINGS_MAX; 
         MappingNum++) {
 
         PSCATTER_GATHER_ENTRY Entry =
-            reinterpret_cast <PSCATTER_GATHER_ENTRY> (
-                ExAllocateFromNPagedLookasideList (
-                    &m_ScatterGatherLookaside
-                    )
-                );
-
-        if (!Entry) {
-            break;
-        }
+            &m_ScatterGatherMappings [Tail & (SCATTER_GATHER_MAPPINGS_MAX - 1)];
 
         Entry -> Virtual    = *Buffer;
         Entry -> ByteCount  = Mappings -> ByteCount;
+        Entry -> CloneEntry = Clone;
 
         //
         // Move forward a specific number of bytes in chunking this into
@@ -619,15 +598,18 @@ Return Value:
             (reinterpret_cast <PUCHAR> (Mappings) + MappingStride)
             );
 
-        InsertTailList (&m_ScatterGatherMappings, &(Entry -> ListEntry));
+        Tail++;
         MappingsInserted++;
-        m_ScatterGatherMappingsQueued++;
-        m_ScatterGatherBytesQueued += Entry -> ByteCount;
+        InterlockedExchangeAdd (&m_ScatterGatherBytesQueued, Entry -> ByteCount);
 
     }
 #endif
 
-    KeReleaseSpinLock (&m_ListLock, Irql);
+    //
+    // Publish the new entries.  The release orders the entry contents
+    // before the tail the simulated interrupt reads.
+    //
+    WriteRelease (&m_ScatterGatherTail, (LONG) Tail);
 
     return MappingsInserted;
 
@@ -661,10 +643,11 @@ Return Value:
 {
 
     //
-    // We're using this list lock to protect our scatter / gather lists instead
-    // of some hardware mechanism / KeSynchronizeExecution / whatever.
+    // We are the only writer of the head.  Entries up to the tail are
+    // complete once we have read it.
     //
-    KeAcquireSpinLockAtDpcLevel (&m_ListLock);
+    ULONG Head = (ULONG) m_ScatterGatherHead;
+    ULONG Tail = (ULONG) ReadAcquire (&m_ScatterGatherTail);
 
     PUCHAR Buffer = reinterpret_cast <PUCHAR> (m_SynthesisBuffer);
     ULONG BufferRemaining = m_ImageSize;
@@ -678,20 +661,11 @@ Return Value:
     // for a buffer if all of them fit in the table also...
     //
     while (BufferRemaining &&
-        m_ScatterGatherMappingsQueued > 0 &&
-        m_ScatterGatherBytesQueued >= BufferRemaining) {
-
-        LIST_ENTRY *listEntry = RemoveHeadList (&m_ScatterGatherMappings);
-        m_ScatterGatherMappingsQueued--;
+        Head != Tail &&
+        (ULONG) ReadNoFence (&m_ScatterGatherBytesQueued) >= BufferRemaining) {
 
         PSCATTER_GATHER_ENTRY SGEntry =  
-            reinterpret_cast <PSCATTER_GATHER_ENTRY> (
-                CONTAINING_RECORD (
-                    listEntry,
-                    SCATTER_GATHER_ENTRY,
-                    ListEntry
-                    )
-                );
+            &m_ScatterGatherMappings [Head & (SCATTER_GATHER_MAPPINGS_MAX - 1)];
 
         //
         // Since we're software, we'll be accessing this by virtual address...
@@ -701,44 +675,57 @@ Return Value:
             BufferRemaining :
             SGEntry -> ByteCount;
 
-        LONG Width = m_Width*(m_ImageSynth->GetBytesPerPixel());
+        if (SGEntry -> ByteCount < m_ImageSize) {
 
-        LONG Stride = Width;
-        if(SGEntry->CloneEntry->StreamHeader->Size >= sizeof(KSSTREAM_HEADER)+sizeof(KS_FRAME_INFO))
-        {
-            PKS_FRAME_INFO FrameInfo = reinterpret_cast <PKS_FRAME_INFO> (SGEntry->CloneEntry->StreamHeader+1);
-            if(FrameInfo->lSurfacePitch != 0)
+            //
+            // The entry maps only part of a frame (one page on x86), so the
+            // frame has its natural pitch.
+            //
+            RtlCopyMemory (SGEntry -> Virtual, Buffer, BytesToCopy);
+            Buffer += BytesToCopy;
+            BufferRemaining -= BytesToCopy;
+
+        } else {
+
+            LONG Width = m_Width*(m_ImageSynth->GetBytesPerPixel());
+
+            LONG Stride = Width;
+            if(SGEntry->CloneEntry->StreamHeader->Size >= sizeof(KSSTREAM_HEADER)+sizeof(KS_FRAME_INFO))
             {
-                Stride = FrameInfo->lSurfacePitch;
-                if(FrameInfo->lSurfacePitch < 0)
+                PKS_FRAME_INFO FrameInfo = reinterpret_cast <PKS_FRAME_INFO> (SGEntry->CloneEntry->StreamHeader+1);
+                if(FrameInfo->lSurfacePitch != 0)
                 {
-                    Stride = -Stride;
+                    Stride = FrameInfo->lSurfacePitch;
+                    if(FrameInfo->lSurfacePitch < 0)
+                    {
+                        Stride = -Stride;
+                    }
                 }
             }
-        }
 
-        for(ULONG y = 0; y < m_Height; y++)
-        {
-            RtlCopyMemory((SGEntry->Virtual+(ULONG)Stride*y), Buffer, Width);
-            Buffer += Width;
-            BytesToCopy -= Width;
-            BufferRemaining -= Width;
+            for(ULONG y = 0; y < m_Height; y++)
+            {
+                RtlCopyMemory((SGEntry->Virtual+(ULONG)Stride*y), Buffer, Width);
+                Buffer += Width;
+                BytesToCopy -= Width;
+                BufferRemaining -= Width;
+            }
         }
 
         m_NumMappingsCompleted++;
-        m_ScatterGatherBytesQueued -= SGEntry -> ByteCount;
+        InterlockedExchangeAdd (
+            &m_ScatterGatherBytesQueued,
+            -(LONG) SGEntry -> ByteCount
+            );
 
         //
-        // Release the scatter / gather entry back to our lookaside.
+        // Hand the entry back to ProgramScatterGatherMappings.  The release
+        // keeps our reads of it ahead of its reuse.
         //
-        ExFreeToNPagedLookasideList (
-            &m_ScatterGatherLookaside,
-            reinterpret_cast <PVOID> (SGEntry)
-            );
+        Head++;
+        WriteRelease (&m_ScatterGatherHead, (LONG) Head);
 
     }
-    
-    KeReleaseSpinLockFromDpcLevel (&m_ListLock);
 
     if (BufferRemaining) return STATUS_INSUFFICIENT_RESOURCES;
     else return STATUS_SUCCESS;
@@ -850,11 +837,7 @@ Return Value:
         //
         // Reschedule the timer for the next interrupt time.
         //
-        LARGE_INTEGER NextTime;
-        NextTime.QuadPart = m_StartTime.QuadPart + 
-            (m_TimePerFrame * (m_InterruptTime + 1));
-
-        KeSetTimer (&m_IsrTimer, NextTime, &m_IsrFakeDpc);
+        ScheduleInterrupt ();
         
     } else {
         //
@@ -866,3 +849,61 @@ Return Value:
     }
 
 }
+
+/*************************************************/
+
+
+void
+CHardwareSimulation::
+ScheduleInterrupt (
+    )
+
+/*++
+
+Routine Description:
+
+    Set the timer for the interrupt after m_InterruptTime.  Interrupts sit
+    on a grid m_TimePerFrame apart from m_StartTime, so they do not drift.
+    If the next one is already due, the missed ones are not replayed in a
+    burst; they are counted as skipped frames and the grid moves on.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+
+{
+
+    LONGLONG Now = (LONGLONG) KeQueryInterruptTimePrecise (NULL);
+    LONGLONG Due = m_StartTime.QuadPart +
+        (m_TimePerFrame * (m_InterruptTime + 1));
+
+    if (Due <= Now) {
+
+        ULONG Missed = (ULONG)
+            ((Now - m_StartTime.QuadPart) / m_TimePerFrame - m_InterruptTime);
+
+        m_InterruptTime += Missed;
+        InterlockedExchangeAdd (PLONG (&m_NumFramesSkipped), (LONG) Missed);
+
+        Due = m_StartTime.QuadPart + 
+            (m_TimePerFrame * (m_InterruptTime + 1));
+
+    }
+
+    //
+    // A negative due time is relative, which the high resolution timer
+    // keeps to the interrupt time clock.
+    //
+    EXT_SET_PARAMETERS Parameters;
+    ExInitializeSetTimerParameters (&Parameters);
+
+    ExSetTimer (m_IsrTimer, Now - Due, 0, &Parameters);
+
+}
+
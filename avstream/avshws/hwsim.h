@@ -26,25 +26,33 @@
 //
 // SCATTER_GATHER_MAPPINGS_MAX:
 //
-// The maximum number of entries in the hardware's scatter/gather list.  I
-// am making this so large for a few reasons:
+// The maximum number of entries in the hardware's scatter/gather table.  It
+// must hold AVSHWS_FRAMES_IN_FLIGHT frames:
 //
-//     1) we're faking this with uncompressed surfaces -- 
+//     1) on x86 we're faking this with uncompressed surfaces -- 
 //            these are large buffers which will map to a lot of s/g entries
-//     2) the fake hardware implementation requires at least one frame's
-//            worth of s/g entries to generate a frame
+//            (one per page)
+//     2) elsewhere each frame buffer is a single entry
 //
-#define SCATTER_GATHER_MAPPINGS_MAX 128
+// The table is a ring indexed with a mask, so this must be a power of 2.
+//
+#if defined(_X86_)
+#define SCATTER_GATHER_MAPPINGS_MAX 512
+#else
+#define SCATTER_GATHER_MAPPINGS_MAX 16
+#endif
+
+C_ASSERT ((SCATTER_GATHER_MAPPINGS_MAX & (SCATTER_GATHER_MAPPINGS_MAX - 1)) == 0);
+C_ASSERT (SCATTER_GATHER_MAPPINGS_MAX >= AVSHWS_FRAMES_IN_FLIGHT);
 
 //
 // SCATTER_GATHER_ENTRY:
 //
-// This structure is used to keep the scatter gather table for the fake
-// hardware as a doubly linked list.
+// This structure is one entry of the scatter gather table for the fake
+// hardware.
 //
 typedef struct _SCATTER_GATHER_ENTRY {
 
-    LIST_ENTRY ListEntry;
     PKSSTREAM_POINTER CloneEntry;
     PUCHAR Virtual;
     ULONG ByteCount;
@@ -82,16 +90,16 @@ private:
     ULONG m_ImageSize;
 
     //
-    // Scatter gather mappings for the simulated hardware.
-    //
-    KSPIN_LOCK m_ListLock;
-    LIST_ENTRY m_ScatterGatherMappings;
-
-    //
-    // Lookaside for memory for the scatter / gather entries on the scatter /
-    // gather list.
+    // Scatter gather mappings for the simulated hardware.  The table is a
+    // single producer / single consumer ring, so it needs no lock:
+    // ProgramScatterGatherMappings (serialized by the pin's processing) is
+    // the only writer of m_ScatterGatherTail and the simulated interrupt is
+    // the only writer of m_ScatterGatherHead.  Both count up forever; an
+    // entry's slot is its index masked by SCATTER_GATHER_MAPPINGS_MAX - 1.
     //
-    NPAGED_LOOKASIDE_LIST m_ScatterGatherLookaside;
+    SCATTER_GATHER_ENTRY m_ScatterGatherMappings [SCATTER_GATHER_MAPPINGS_MAX];
+    volatile LONG m_ScatterGatherHead;
+    volatile LONG m_ScatterGatherTail;
 
     //
     // The current state of the fake hardware.
@@ -104,12 +112,6 @@ private:
     BOOLEAN m_StopHardware;
     KEVENT m_HardwareEvent;
 
-    //
-    // Maximum number of scatter / gather mappins in the s/g table of the
-    // fake hardware.
-    //
-    ULONG m_ScatterGatherMappingsMax;
-
     //
     // Number of scatter / gather mappings that have been completed (total)
     // since the start of the hardware or any reset.
@@ -117,10 +119,10 @@ private:
     ULONG m_NumMappingsCompleted;
 
     //
-    // Number of scatter / gather mappings that are queued for this hardware.
+    // Number of bytes of scatter / gather mappings that are queued for this
+    // hardware.
     //
-    ULONG m_ScatterGatherMappingsQueued;
-    ULONG m_ScatterGatherBytesQueued;
+    volatile LONG m_ScatterGatherBytesQueued;
 
     //
     // Number of frames skipped due to lack of scatter / gather mappings.
@@ -134,15 +136,16 @@ private:
     ULONG m_InterruptTime;
 
     //
-    // The system time at start.
+    // The interrupt time at start.  Interrupts are scheduled on a grid of
+    // m_TimePerFrame from here.
     //
     LARGE_INTEGER m_StartTime;
     
     //
-    // The DPC used to "fake" ISR
+    // The high resolution timer used to "fake" ISR.  Its callback runs at
+    // DISPATCH_LEVEL, like a DPC.
     //
-    KDPC m_IsrFakeDpc;
-    KTIMER m_IsrTimer;
+    PEX_TIMER m_IsrTimer;
 
     //
     // The hardware sink that will be used for interrupt notifications.
@@ -159,6 +162,15 @@ private:
     FillScatterGatherBuffers (
         );
 
+    //
+    // ScheduleInterrupt():
+    //
+    // Set the timer for the interrupt after m_InterruptTime.
+    //
+    void
+    ScheduleInterrupt (
+        );
+
 public:
 
     LONG GetSkippedFrameCount()
@@ -181,9 +193,7 @@ public:
     // The hardware simulation destructor.
     //
     ~CHardwareSimulation (
-        )
-    {
-    }
+        );
 
     //
     // Cleanup():
@@ -431,7 +431,9 @@ COutPin::COutPin(
     _In_     IKsControl*   pIksControl  
     )
     : CBasePin( ulPinId, pparent ),
-    m_firstSample( false )
+    m_firstSample( false ),
+    m_pWorkItem( nullptr ),
+    m_workItemQueued( FALSE )
 {
     HRESULT         hr              = S_OK;
     CPinState*      pState          = NULL;
@@ -464,6 +466,9 @@ COutPin::COutPin(
     //
     m_Ikscontrol = pIksControl;
 
+    m_pWorkItem = new (std::nothrow) CPinWorkItem( this );
+    DMFTCHECKNULL_GOTO( m_pWorkItem, done, E_OUTOFMEMORY );
+
     MFCreateAttributes( &pAttributes, 3 ); //Create the space for the attribute store!!
     setAttributes( pAttributes );
     DMFTCHECKHR_GOTO( SetUINT32( MFT_SUPPORT_DYNAMIC_FORMAT_CHANGE, TRUE ), done );
@@ -497,6 +502,13 @@ COutPin::~COutPin()
     }
     m_states.clear();
     m_queues.clear();
+
+    for ( ULONG ulIndex = 0, ulSize = (ULONG)m_pendingSamples.size(); ulIndex < ulSize; ulIndex++ )
+    {
+        SAFE_RELEASE( m_pendingSamples[ ulIndex ].first );
+    }
+    m_pendingSamples.clear();
+    SAFE_RELEASE( m_pWorkItem );
 }
 
 /*++
@@ -567,19 +579,116 @@ STDMETHODIMP COutPin::AddSampleInternal( _In_ IMFSample *pSample, _In_ CBasePin
 COutPin::AddSample
 Description:
 Called when ProcessInput is called on the Device Transform. The Input Pin puts the samples
-in the pins connected. If the Output pins are in open state the sample lands in the queues
+in the pins connected. If the Output pins are in open state the sample is held for the pin's
+work item, which lands it in the queues from the device transform's work queue. ProcessInput
+does not wait for the tee (possibly an XVP) to run. At most DMFT_MAX_PENDING_SAMPLES are held;
+if the work queue falls behind the oldest one is dropped, as a live source would.
 --*/
 
 STDMETHODIMP COutPin::AddSample( _In_ IMFSample *pSample, _In_ CBasePin *pPin)
 {
-    HRESULT hr = S_OK;
-    CAutoLock lock( lock() );
-    
+    HRESULT     hr          = S_OK;
+    IMFSample*  pDropped    = nullptr;
+    BOOL        queueWork   = FALSE;
+
+    //
+    // Early out only, ProcessPendingSamples checks the state again under the pin lock
+    //
     DMFTCHECKHR_GOTO( m_state->Open(), done );
-    
-    DMFTCHECKHR_GOTO( AddSampleInternal( pSample, pPin ),done );
+    DMFTCHECKNULL_GOTO( m_pWorkItem, done, E_OUTOFMEMORY );
+    {
+        CAutoLock Lock( m_pendingLock );
+
+        if ( m_pendingSamples.size() >= DMFT_MAX_PENDING_SAMPLES )
+        {
+            pDropped = m_pendingSamples.front().first;
+            m_pendingSamples.erase( m_pendingSamples.begin() );
+        }
+        DMFTCHECKHR_GOTO( ExceptionBoundary( [&]()
+        {
+            m_pendingSamples.push_back( make_pair( pSample, pPin ) );
+        }), done );
+        pSample->AddRef();
+
+        if ( !m_workItemQueued )
+        {
+            m_workItemQueued = TRUE;
+            queueWork = TRUE;
+        }
+    }
+
+    if ( queueWork )
+    {
+        //
+        // The work item holds a reference on the pin till it has run
+        //
+        AddRef();
+        if ( FAILED( MFPutWorkItem2( Parent()->GetWorkQueueId(), Parent()->GetWorkQueuePriority(), m_pWorkItem, nullptr ) ) )
+        {
+            //
+            // Process the sample on this thread then
+            //
+            (VOID)ProcessPendingSamples();
+            Release();
+        }
+    }
 
 done:
+    if ( pDropped )
+    {
+        DMFTRACE( DMFT_GENERAL, TRACE_LEVEL_INFORMATION, "%!FUNC! Pin %d dropping sample %p, work queue is behind", streamId(), pDropped );
+        SAFE_RELEASE( pDropped );
+    }
+    return hr;
+}
+
+/*++
+COutPin::ProcessPendingSamples
+Description:
+Called from the pin's work item on the device transform's work queue. Passes the pending samples
+through the tees in the order they arrived and notifies the device transform manager of each
+output sample. Only one work item is queued per pin at a time so its samples stay in order,
+while the pins of a multi-stream camera are processed in parallel.
+--*/
+STDMETHODIMP COutPin::ProcessPendingSamples( )
+{
+    HRESULT     hr = S_OK;
+
+    for ( ;; )
+    {
+        IMFSample*  pSample = nullptr;
+        CBasePin*   pPin    = nullptr;
+        BOOL        added   = FALSE;
+        {
+            CAutoLock Lock( m_pendingLock );
+
+            if ( m_pendingSamples.empty() )
+            {
+                m_workItemQueued = FALSE;
+                break;
+            }
+            pSample = m_pendingSamples.front().first;
+            pPin    = m_pendingSamples.front().second;
+            m_pendingSamples.erase( m_pendingSamples.begin() );
+        }
+        {
+            CAutoLock Lock( lock() );
+            //
+            // The pin may have been closed or flushed since the sample arrived
+            //
+            if ( SUCCEEDED( m_state->Open() ) )
+            {
+                hr = AddSampleInternal( pSample, pPin );
+                added = SUCCEEDED( hr );
+            }
+        }
+        SAFE_RELEASE( pSample );
+
+        if ( added )
+        {
+            Parent()->QueueEvent( METransformHaveOutput, GUID_NULL, S_OK, NULL );
+        }
+    }
     return hr;
 }
 
@@ -635,6 +744,15 @@ HRESULT COutPin::FlushQueues()
         CPinQueue *que = m_queues[ dwIndex ];
         que->Clear();
     }
+    {
+        CAutoLock PendingLock( m_pendingLock );
+
+        for ( DWORD dwIndex = 0, dwSize = (DWORD) m_pendingSamples.size(); dwIndex < dwSize; dwIndex++ )
+        {
+            SAFE_RELEASE( m_pendingSamples[ dwIndex ].first );
+        }
+        m_pendingSamples.clear();
+    }
 
      DMFTRACE(DMFT_GENERAL, TRACE_LEVEL_INFORMATION, "%!FUNC! exiting %x = %!HRESULT!", hr, hr);
     return hr;
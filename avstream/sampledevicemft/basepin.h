@@ -15,6 +15,7 @@ extern DeviceStreamState pinStateTransition[][4];
 
 class CPinQueue;
 class CPinState;
+class CPinWorkItem;
 class CMultipinMft;
 
 class CBasePin:
@@ -566,6 +567,8 @@ public:
     STDMETHODIMP_(VOID) SetFirstSample(
         _In_    BOOL 
         );
+    STDMETHODIMP ProcessPendingSamples(
+        );
 
     
 private:
@@ -573,6 +576,10 @@ private:
     CPinState*                m_state;            /*Current state*/
     vector< CPinQueue *>      m_queues;           /*List of Queues corresponding to input pins*/
     BOOL                      m_firstSample;
+    CCritSec                  m_pendingLock;      /*Guards m_pendingSamples and m_workItemQueued*/
+    vector< pair< IMFSample*, CBasePin* > > m_pendingSamples; /*Samples and their input pins waiting for the work queue, oldest first*/
+    CPinWorkItem*             m_pWorkItem;        /*Services m_pendingSamples on the work queue*/
+    BOOL                      m_workItemQueued;   /*Set while a work item for this pin is queued or running*/
    friend class CPinState;
 };
 
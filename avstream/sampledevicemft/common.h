@@ -12,6 +12,9 @@
 #define GUID_BUFFER_SIZE    37
 #define SLEEP_5MILLISEC 5
 #define SLEEP_ONE_SECOND 1000 // One second in milli seconds.
+#define DMFT_MAX_PENDING_SAMPLES 4 // Samples an output pin holds for the work queue before it drops the oldest.
+#define DMFT_XVP_POOL_INITIAL_SAMPLES 2 // Samples the XVP tee's allocator creates up front.
+#define DMFT_XVP_POOL_MAX_SAMPLES 8 // Samples the XVP tee's allocator recycles before it falls back to per frame allocation.
 
 #ifndef MF_WPP
 #define DMFTRACE(...) 
@@ -438,7 +438,8 @@ STDMETHODIMP CMultipinMft::SetWorkQueueEx(
 {
     CAutoLock   lock( m_critSec );
     //
-    // Cache the WorkQueuId and WorkItemBasePriority
+    // Cache the WorkQueuId and WorkItemBasePriority. The output pins queue
+    // their sample processing there
     //
     m_dwWorkQueueId = dwWorkQueueId;
     m_lWorkQueuePriority = lWorkItemBasePriority;
@@ -780,6 +781,8 @@ STDMETHODIMP  CMultipinMft::ProcessInput(
         when the sourcetransform has input to feed. the pins will try to deliver the 
         samples to the active output pins conencted. if none are connected then just
         returns the sample back to the source transform
+        The output pins process the samples on the work queue set by SetWorkQueueEx
+        and send METransformHaveOutput once a sample is ready, see COutPin::AddSample
 
 --*/
 {
@@ -797,8 +800,6 @@ STDMETHODIMP  CMultipinMft::ProcessInput(
     }
 
     DMFTCHECKHR_GOTO( inPin->SendSample( pSample ), done );
-
-    QueueEvent( METransformHaveOutput, GUID_NULL, S_OK, NULL );
    
 done:
     SAFERELEASE( pSample );
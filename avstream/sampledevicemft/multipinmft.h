@@ -292,6 +292,18 @@ public:
         return m_filterHasIndependentPin;
     }
 
+    //
+    //Used by the output pins to queue their work items, see COutPin::AddSample
+    //
+    __inline DWORD GetWorkQueueId()
+    {
+        return m_dwWorkQueueId;
+    }
+    __inline LONG GetWorkQueuePriority()
+    {
+        return m_lWorkQueuePriority;
+    }
+
     //
     //Will be used from Pins to get the D3D manager once set!!!
     //
@@ -86,6 +86,75 @@ VOID CPinQueue::Clear( )
     }
 }
 
+//
+//Pin work item implementation
+//
+
+CPinWorkItem::CPinWorkItem( _In_ COutPin *pPin )
+:   m_nRefCount( 1 ),
+    m_pPin( pPin )
+{
+}
+
+STDMETHODIMP_(ULONG) CPinWorkItem::AddRef( )
+{
+    return InterlockedIncrement( &m_nRefCount );
+}
+
+STDMETHODIMP_(ULONG) CPinWorkItem::Release( )
+{
+    ULONG uCount = InterlockedDecrement( &m_nRefCount );
+    if ( uCount == 0 )
+    {
+        delete this;
+    }
+    return uCount;
+}
+
+STDMETHODIMP CPinWorkItem::QueryInterface( _In_ REFIID riid, _COM_Outptr_ void **ppv )
+{
+    HRESULT hr = S_OK;
+    DMFTCHECKNULL_GOTO( ppv, done, E_POINTER );
+    *ppv = nullptr;
+
+    if ( ( riid == __uuidof( IMFAsyncCallback ) ) || ( riid == __uuidof( IUnknown ) ) )
+    {
+        *ppv = static_cast< IMFAsyncCallback* >( this );
+        AddRef();
+    }
+    else
+    {
+        hr = E_NOINTERFACE;
+    }
+done:
+    return hr;
+}
+
+/*++
+Description:
+    The queue is picked by MFPutWorkItem2, so just use the defaults
+--*/
+STDMETHODIMP CPinWorkItem::GetParameters( _Out_ DWORD *pdwFlags, _Out_ DWORD *pdwQueue )
+{
+    UNREFERENCED_PARAMETER( pdwFlags );
+    UNREFERENCED_PARAMETER( pdwQueue );
+    return E_NOTIMPL;
+}
+
+/*++
+Description:
+    Runs on the work queue. Drains the pin's pending samples and drops the
+    reference to the pin that COutPin::AddSample took when it queued us
+--*/
+STDMETHODIMP CPinWorkItem::Invoke( _In_ IMFAsyncResult *pAsyncResult )
+{
+    UNREFERENCED_PARAMETER( pAsyncResult );
+
+    (VOID)m_pPin->ProcessPendingSamples();
+    m_pPin->Release();
+    return S_OK;
+}
+
 /*++
 Description:
     RecreateTee creates the underlying Tees in the queue. It accepts the input media type
@@ -254,7 +323,25 @@ STDMETHODIMP CXvptee::Do(_In_ IMFSample *pSample, _Outptr_ IMFSample** pOutSampl
     outputSample.dwStreamID = 0;
     outputSample.pSample = NULL;
 
-    if (!(isDx && m_spDeviceManagerUnk!=nullptr))
+    if (m_spAllocator != nullptr)
+    {
+        //
+        //Recycle a sample from the pool. If the pipeline is holding on to all of them
+        //the pool is empty, and we fall back to the allocations below
+        //
+        if (SUCCEEDED(m_spAllocator->AllocateSample(&spXVPOutputSample)))
+        {
+            DMFTCHECKHR_GOTO(spXVPOutputSample->DeleteAllItems(), done);
+            DMFTCHECKHR_GOTO(pSample->CopyAllItems(spXVPOutputSample), done);
+            outputSample.pSample = spXVPOutputSample;
+        }
+        else
+        {
+            DMFTRACE(DMFT_GENERAL, TRACE_LEVEL_INFORMATION, "%!FUNC! XVP sample pool is empty, allocating a sample");
+        }
+    }
+
+    if (!outputSample.pSample && !(isDx && m_spDeviceManagerUnk!=nullptr))
     {
         //
         //Create a new sample for software encoding
@@ -487,12 +574,65 @@ STDMETHODIMP CXvptee::Configure(
         DMFTCHECKHR_GOTO((*ppTransform)->MFTProcessMessage(MFT_MESSAGE_SET_D3D_MANAGER,
             reinterpret_cast<ULONG_PTR>(m_spDeviceManagerUnk.Get())), done);
     }
+    if ( !imageType )
+    {
+        //
+        //Without a pool the XVP output samples are allocated per frame, so carry on
+        //
+        (VOID)CreateSampleAllocator( outMediaType );
+    }
 done:
     SAFE_RELEASE(pXvpOutputMediaType);
     return hr;
 
 }
 
+/*++
+Description:
+    Create the allocator that recycles the XVP output samples. If the device transform
+    has a DXGI device manager the samples are backed by D3D11 textures the XVP renders
+    into, so the frames stay on the GPU. Otherwise they are system memory samples, which
+    still saves allocating and zeroing a buffer for each frame.
+--*/
+STDMETHODIMP CXvptee::CreateSampleAllocator( _In_ IMFMediaType *pOutMediaType )
+{
+    HRESULT hr = S_OK;
+    ComPtr<IMFDXGIDeviceManager> spDXGIManager = nullptr;
+    ComPtr<IMFAttributes>        spAttributes  = nullptr;
+
+    if (m_spAllocator != nullptr)
+    {
+        (VOID)m_spAllocator->UninitializeSampleAllocator();
+        m_spAllocator = nullptr;
+    }
+
+    DMFTCHECKHR_GOTO(MFCreateVideoSampleAllocatorEx(IID_PPV_ARGS(&m_spAllocator)), done);
+    DMFTCHECKHR_GOTO(MFCreateAttributes(&spAttributes, 2), done);
+    DMFTCHECKHR_GOTO(spAttributes->SetUINT32(MF_SA_BUFFERS_PER_SAMPLE, 1), done);
+
+    if ( (m_spDeviceManagerUnk != nullptr) && SUCCEEDED(m_spDeviceManagerUnk.As(&spDXGIManager)) )
+    {
+        DMFTCHECKHR_GOTO(m_spAllocator->SetDirectXManager(spDXGIManager.Get()), done);
+        DMFTCHECKHR_GOTO(spAttributes->SetUINT32(MF_SA_D3D11_BINDFLAGS, D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE), done);
+    }
+
+    DMFTCHECKHR_GOTO(m_spAllocator->InitializeSampleAllocatorEx(
+        DMFT_XVP_POOL_INITIAL_SAMPLES,
+        DMFT_XVP_POOL_MAX_SAMPLES,
+        spAttributes.Get(),
+        pOutMediaType), done);
+
+    DMFTRACE(DMFT_GENERAL, TRACE_LEVEL_INFORMATION, "%!FUNC! XVP sample pool created, D3D11 %d", (spDXGIManager != nullptr));
+
+done:
+    if (FAILED(hr))
+    {
+        DMFTRACE(DMFT_GENERAL, TRACE_LEVEL_INFORMATION, "%!FUNC! XVP sample pool not available %x = %!HRESULT!", hr, hr);
+        m_spAllocator = nullptr;
+    }
+    return hr;
+}
+
 
 CXvptee::CXvptee( _In_ Ctee *tee) :
 CWrapTee(tee),
@@ -509,6 +649,14 @@ CWrapTee(tee),
 
 CXvptee::~CXvptee()
 {
+    //
+    //Samples the pipeline still holds stay valid, they are freed when released
+    //
+    if (m_spAllocator != nullptr)
+    {
+        (VOID)m_spAllocator->UninitializeSampleAllocator();
+        m_spAllocator = nullptr;
+    }
     m_spDeviceManagerUnk = nullptr;
 }
 
@@ -15,6 +15,7 @@
 //Queue class!!!
 //
 class Ctee;
+class COutPin;
 //typedef CMFAttributesTrace CMediaTypeTrace; /* Only used for debug. take this out*/
 
 
@@ -52,6 +53,32 @@ private:
 
 };
 
+//
+// Work item that services the pending samples of an output pin on the
+// work queue set by IMFRealTimeClientEx::SetWorkQueueEx
+//
+class CPinWorkItem : public IMFAsyncCallback{
+public:
+    CPinWorkItem( _In_ COutPin *pPin );
+
+    //
+    //IUnknown
+    //
+    STDMETHODIMP_(ULONG) AddRef();
+    STDMETHODIMP_(ULONG) Release();
+    STDMETHODIMP QueryInterface( _In_ REFIID riid, _COM_Outptr_ void **ppv );
+
+    //
+    //IMFAsyncCallback
+    //
+    STDMETHODIMP GetParameters( _Out_ DWORD *pdwFlags, _Out_ DWORD *pdwQueue );
+    STDMETHODIMP Invoke( _In_ IMFAsyncResult *pAsyncResult );
+
+private:
+    ULONG                m_nRefCount;
+    COutPin*             m_pPin;                /*Not referenced, the pin owns the work item */
+};
+
 class CPinState{
 public:
     virtual STDMETHODIMP Open() = 0;
@@ -183,11 +210,14 @@ public:
     STDMETHODIMP_(VOID) SetD3DManager( IUnknown* punk );
 
 private:
+    STDMETHODIMP CreateSampleAllocator( _In_ IMFMediaType * );
+
     BOOL  m_isoptimizedPlanarInputOutput;
     BOOL  m_isOutPutImage;
     UINT32 m_uWidth;
     UINT32 m_uHeight;
     ComPtr<IUnknown> m_spDeviceManagerUnk;
+    ComPtr<IMFVideoSampleAllocatorEx> m_spAllocator;   /*Recycles the XVP output samples, D3D11 backed if a DXGI manager is set*/
 };
 
 class CDecoderTee : public CWrapTee{
@@ -0,0 +1,32 @@
+//// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+//// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+//// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+//// PARTICULAR PURPOSE.
+////
+//// Copyright (c) Microsoft Corporation. All rights reserved
+
+// ClearRows.hlsl : Compute shader for the GPU path of the CMft0 effect.
+// Zeroes the rows of one plane from FirstRow down, like the memset of
+// CMft0::OnProcessOutput. The view selects the plane and the array slice.
+// Built into g_ClearRowsCS in ClearRows.h.
+
+RWTexture2DArray<unorm float4> Target : register(u0);
+
+cbuffer ClearRowsConstants : register(b0)
+{
+    uint FirstRow;
+    uint Width;
+    uint Height;
+    uint Reserved;
+};
+
+[numthreads(8, 8, 1)]
+void main(uint3 id : SV_DispatchThreadID)
+{
+    uint2 pos = uint2(id.x, FirstRow + id.y);
+
+    if (pos.x < Width && pos.y < Height)
+    {
+        Target[uint3(pos, 0)] = 0;
+    }
+}
@@ -0,0 +1,245 @@
+//// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+//// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+//// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+//// PARTICULAR PURPOSE.
+////
+//// Copyright (c) Microsoft Corporation. All rights reserved
+
+// D3D11Effect.cpp : Implementation of CD3D11Effect
+
+#include "stdafx.h"
+#include "SampleHelpers.h"
+#include "D3D11Effect.h"
+#include "ClearRows.h"      // g_ClearRowsCS, built from ClearRows.hlsl
+
+#define CLEARROWS_GROUP_SIZE 8  // numthreads of ClearRows.hlsl, in both directions.
+
+HRESULT CD3D11Effect::SetDeviceManager(IMFDXGIDeviceManager *pManager)
+{
+    HRESULT hr = S_OK;
+
+    if (m_spManager && m_hDevice)
+    {
+        (void)m_spManager->CloseDeviceHandle(m_hDevice);
+    }
+    m_hDevice = NULL;
+    m_spShader.Release();
+    m_spConstants.Release();
+    m_spDevice.Release();
+    m_spManager.Release();
+
+    do {
+        if (!pManager)
+        {
+            break;
+        }
+        CHK_LOG_BRK(pManager->OpenDeviceHandle(&m_hDevice));
+        m_spManager = pManager;
+    } while (FALSE);
+
+    return hr;
+}
+
+HRESULT CD3D11Effect::CreateResources(ID3D11Device *pDevice)
+{
+    HRESULT hr = S_OK;
+    D3D11_BUFFER_DESC bufferDesc = {0};
+
+    m_spShader.Release();
+    m_spConstants.Release();
+    m_spDevice.Release();
+
+    do {
+        // The shader is cs_5_0.
+        if (pDevice->GetFeatureLevel() < D3D_FEATURE_LEVEL_11_0)
+        {
+            hr = MF_E_UNSUPPORTED_D3D_TYPE;
+            break;
+        }
+        CHK_LOG_BRK(pDevice->CreateComputeShader(g_ClearRowsCS, sizeof(g_ClearRowsCS), NULL, &m_spShader));
+
+        bufferDesc.ByteWidth = 4 * sizeof(UINT);
+        bufferDesc.Usage = D3D11_USAGE_DEFAULT;
+        bufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+        CHK_LOG_BRK(pDevice->CreateBuffer(&bufferDesc, NULL, &m_spConstants));
+
+        m_spDevice = pDevice;
+    } while (FALSE);
+
+    return hr;
+}
+
+// GetViewFormat: Pick the UAV format for the first plane of the texture,
+// and its width in elements. These are the view formats Direct3D allows for
+// the video formats a camera produces; anything else takes the CPU path.
+HRESULT CD3D11Effect::GetViewFormat(
+    ID3D11Device *pDevice,
+    const D3D11_TEXTURE2D_DESC &desc,
+    UINT uiWidth,
+    DXGI_FORMAT *pFormat,
+    UINT *puiViewWidth)
+{
+    HRESULT hr = S_OK;
+    UINT uiSupport = 0;
+    D3D11_FEATURE_DATA_FORMAT_SUPPORT2 support2 = {};
+
+    do {
+        switch (desc.Format)
+        {
+        case DXGI_FORMAT_NV12:
+            // The R8 view is the luma plane.
+            *pFormat = DXGI_FORMAT_R8_UNORM;
+            *puiViewWidth = uiWidth;
+            break;
+        case DXGI_FORMAT_YUY2:
+            // One element per macro-pixel.
+            *pFormat = DXGI_FORMAT_R8G8B8A8_UNORM;
+            *puiViewWidth = uiWidth / 2;
+            break;
+        case DXGI_FORMAT_B8G8R8A8_UNORM:
+        case DXGI_FORMAT_B8G8R8X8_UNORM:
+            *pFormat = desc.Format;
+            *puiViewWidth = uiWidth;
+            break;
+        default:
+            hr = MF_E_UNSUPPORTED_D3D_TYPE;
+            break;
+        }
+        if (FAILED(hr))
+        {
+            break;
+        }
+
+        support2.InFormat = *pFormat;
+        if (FAILED(pDevice->CheckFormatSupport(*pFormat, &uiSupport)) ||
+            !(uiSupport & D3D11_FORMAT_SUPPORT_TYPED_UNORDERED_ACCESS_VIEW) ||
+            FAILED(pDevice->CheckFeatureSupport(D3D11_FEATURE_FORMAT_SUPPORT2, &support2, sizeof(support2))) ||
+            !(support2.OutFormatSupport2 & D3D11_FORMAT_SUPPORT2_UAV_TYPED_STORE))
+        {
+            hr = MF_E_UNSUPPORTED_D3D_TYPE;
+        }
+    } while (FALSE);
+
+    return hr;
+}
+
+HRESULT CD3D11Effect::Apply(
+    IMFMediaBuffer *pIn,
+    IMFMediaBuffer *pOut,
+    UINT uiWidth,
+    UINT uiHeight,
+    UINT uiFirstRow)
+{
+    HRESULT hr = S_OK;
+    CComPtr<IMFDXGIBuffer> spInBuffer;
+    CComPtr<IMFDXGIBuffer> spOutBuffer;
+    CComPtr<ID3D11Texture2D> spInTexture;
+    CComPtr<ID3D11Texture2D> spOutTexture;
+    CComPtr<ID3D11Device> spDevice;
+    CComPtr<ID3D11DeviceContext> spContext;
+    CComPtr<ID3D11UnorderedAccessView> spView;
+    UINT uiInSubresource = 0,
+         uiOutSubresource = 0,
+         uiViewWidth = 0;
+    DXGI_FORMAT viewFormat = DXGI_FORMAT_UNKNOWN;
+    D3D11_TEXTURE2D_DESC desc = {0};
+    BOOL bLocked = FALSE;
+
+    do {
+        CHK_NULL_PTR_BRK(pIn);
+        CHK_NULL_PTR_BRK(pOut);
+
+        // System memory frames take the CPU path.
+        if (!m_spManager ||
+            FAILED(pIn->QueryInterface(IID_PPV_ARGS(&spInBuffer))) ||
+            FAILED(pOut->QueryInterface(IID_PPV_ARGS(&spOutBuffer))))
+        {
+            hr = MF_E_UNSUPPORTED_D3D_TYPE;
+            break;
+        }
+        CHK_LOG_BRK(spInBuffer->GetResource(IID_PPV_ARGS(&spInTexture)));
+        CHK_LOG_BRK(spInBuffer->GetSubresourceIndex(&uiInSubresource));
+        CHK_LOG_BRK(spOutBuffer->GetResource(IID_PPV_ARGS(&spOutTexture)));
+        CHK_LOG_BRK(spOutBuffer->GetSubresourceIndex(&uiOutSubresource));
+
+        hr = m_spManager->LockDevice(m_hDevice, IID_PPV_ARGS(&spDevice), TRUE);
+        if (hr == MF_E_DXGI_NEW_VIDEO_DEVICE)
+        {
+            // The pipeline replaced the device. Reopen the handle and
+            // recreate the shader on the new one.
+            (void)m_spManager->CloseDeviceHandle(m_hDevice);
+            m_hDevice = NULL;
+            CHK_LOG_BRK(m_spManager->OpenDeviceHandle(&m_hDevice));
+            hr = m_spManager->LockDevice(m_hDevice, IID_PPV_ARGS(&spDevice), TRUE);
+        }
+        CHK_LOG_BRK(hr);
+        bLocked = TRUE;
+
+        if (spDevice != m_spDevice)
+        {
+            hr = CreateResources(spDevice);
+            if (FAILED(hr))
+            {
+                break;
+            }
+        }
+
+        // The shader writes the output texture in place, so it must have been
+        // allocated for unordered access; see GetInputStreamAttributes.
+        spOutTexture->GetDesc(&desc);
+        if (!(desc.BindFlags & D3D11_BIND_UNORDERED_ACCESS))
+        {
+            hr = MF_E_UNSUPPORTED_D3D_TYPE;
+            break;
+        }
+        hr = GetViewFormat(spDevice, desc, uiWidth, &viewFormat, &uiViewWidth);
+        if (FAILED(hr))
+        {
+            break;
+        }
+
+        spDevice->GetImmediateContext(&spContext);
+
+        if ((spInTexture != spOutTexture) || (uiInSubresource != uiOutSubresource))
+        {
+            spContext->CopySubresourceRegion(spOutTexture, uiOutSubresource, 0, 0, 0, spInTexture, uiInSubresource, NULL);
+        }
+
+        if (uiFirstRow < uiHeight)
+        {
+            D3D11_UNORDERED_ACCESS_VIEW_DESC viewDesc = {};
+            viewDesc.Format = viewFormat;
+            viewDesc.ViewDimension = D3D11_UAV_DIMENSION_TEXTURE2DARRAY;
+            viewDesc.Texture2DArray.MipSlice = uiOutSubresource % desc.MipLevels;
+            viewDesc.Texture2DArray.FirstArraySlice = uiOutSubresource / desc.MipLevels;
+            viewDesc.Texture2DArray.ArraySize = 1;
+            CHK_LOG_BRK(spDevice->CreateUnorderedAccessView(spOutTexture, &viewDesc, &spView));
+
+            UINT constants[4] = { uiFirstRow, uiViewWidth, uiHeight, 0 };
+            ID3D11UnorderedAccessView *pView = spView;
+            ID3D11Buffer *pConstants = m_spConstants;
+
+            spContext->UpdateSubresource(m_spConstants, 0, NULL, constants, 0, 0);
+            spContext->CSSetShader(m_spShader, NULL, 0);
+            spContext->CSSetConstantBuffers(0, 1, &pConstants);
+            spContext->CSSetUnorderedAccessViews(0, 1, &pView, NULL);
+            spContext->Dispatch(
+                (uiViewWidth + CLEARROWS_GROUP_SIZE - 1) / CLEARROWS_GROUP_SIZE,
+                (uiHeight - uiFirstRow + CLEARROWS_GROUP_SIZE - 1) / CLEARROWS_GROUP_SIZE,
+                1);
+
+            // Unbind the texture so the rest of the pipeline can use it.
+            pView = NULL;
+            pConstants = NULL;
+            spContext->CSSetUnorderedAccessViews(0, 1, &pView, NULL);
+            spContext->CSSetConstantBuffers(0, 1, &pConstants);
+            spContext->CSSetShader(NULL, NULL, 0);
+        }
+    } while (FALSE);
+
+    if (bLocked)
+    {
+        (void)m_spManager->UnlockDevice(m_hDevice, FALSE);
+    }
+    return hr;
+}
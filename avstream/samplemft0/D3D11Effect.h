@@ -0,0 +1,60 @@
+//// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+//// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+//// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+//// PARTICULAR PURPOSE.
+////
+//// Copyright (c) Microsoft Corporation. All rights reserved
+
+// D3D11Effect.h : Declaration of CD3D11Effect, the GPU path of the CMft0
+// effect. Used when the pipeline negotiates MF_SA_D3D11_AWARE and hands
+// the MFT an IMFDXGIDeviceManager, so texture backed frames never leave
+// the GPU.
+
+#pragma once
+#include "stdafx.h"
+
+class CD3D11Effect
+{
+public:
+    CD3D11Effect() : m_hDevice(NULL)
+    {
+    }
+
+    ~CD3D11Effect()
+    {
+        SetDeviceManager(NULL);
+    }
+
+    // SetDeviceManager: Use pManager for the frames that follow. NULL
+    // drops the device and returns the MFT to system memory frames.
+    HRESULT SetDeviceManager(IMFDXGIDeviceManager *pManager);
+
+    // IsEnabled: Returns TRUE if a device manager has been set.
+    BOOL IsEnabled() const { return m_spManager != NULL; }
+
+    // Apply: Copy pIn to pOut, unless they are the same texture, and zero
+    // the rows of the first plane from uiFirstRow down. Fails with
+    // MF_E_UNSUPPORTED_D3D_TYPE if the buffers are not textures the shader
+    // can write, in which case the caller takes the CPU path.
+    HRESULT Apply(
+        IMFMediaBuffer *pIn,
+        IMFMediaBuffer *pOut,
+        UINT uiWidth,
+        UINT uiHeight,
+        UINT uiFirstRow);
+
+private:
+    HRESULT CreateResources(ID3D11Device *pDevice);
+    HRESULT GetViewFormat(
+        ID3D11Device *pDevice,
+        const D3D11_TEXTURE2D_DESC &desc,
+        UINT uiWidth,
+        DXGI_FORMAT *pFormat,
+        UINT *puiViewWidth);
+
+    CComPtr<IMFDXGIDeviceManager>   m_spManager;
+    HANDLE                          m_hDevice;
+    CComPtr<ID3D11Device>           m_spDevice;         // Device the resources below belong to.
+    CComPtr<ID3D11ComputeShader>    m_spShader;
+    CComPtr<ID3D11Buffer>           m_spConstants;
+};
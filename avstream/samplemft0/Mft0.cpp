@@ -206,10 +206,12 @@ STDMETHODIMP CMft0::GetAttributes(
     do {
         CHK_NULL_PTR_BRK(ppAttributes);
         if(!m_pGlobalAttributes) {
-            CHK_LOG_BRK(MFCreateAttributes(&m_pGlobalAttributes, 3));
+            CHK_LOG_BRK(MFCreateAttributes(&m_pGlobalAttributes, 4));
             CHK_LOG_BRK(m_pGlobalAttributes->SetUINT32(MF_TRANSFORM_ASYNC, FALSE));
             CHK_LOG_BRK(m_pGlobalAttributes->SetString(MFT_ENUM_HARDWARE_URL_Attribute, L"Sample_CameraExtensionMft"));
             CHK_LOG_BRK(m_pGlobalAttributes->SetUINT32(MFT_SUPPORT_DYNAMIC_FORMAT_CHANGE, TRUE));
+            // Ask for texture backed samples; see CD3D11Effect.
+            CHK_LOG_BRK(m_pGlobalAttributes->SetUINT32(MF_SA_D3D11_AWARE, TRUE));
         }
         *ppAttributes = m_pGlobalAttributes;
         (*ppAttributes)->AddRef();
@@ -231,9 +233,11 @@ STDMETHODIMP CMft0::GetInputStreamAttributes(
         }
         CHK_NULL_PTR_BRK(ppAttributes);
         if(!m_pInputAttributes){
-            CHK_LOG_BRK(MFCreateAttributes(&m_pInputAttributes, 2));
+            CHK_LOG_BRK(MFCreateAttributes(&m_pInputAttributes, 3));
             CHK_LOG_BRK(m_pInputAttributes->SetUINT32(MFT_SUPPORT_DYNAMIC_FORMAT_CHANGE, TRUE));
             CHK_LOG_BRK(m_pInputAttributes->SetString(MFT_ENUM_HARDWARE_URL_Attribute, L"Sample_CameraExtensionMft"));
+            // The compute shader writes the frames in place.
+            CHK_LOG_BRK(m_pInputAttributes->SetUINT32(MF_SA_D3D11_BINDFLAGS, D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS));
         }
         *ppAttributes = m_pInputAttributes;
         (*ppAttributes)->AddRef();
@@ -569,7 +573,6 @@ STDMETHODIMP CMft0::ProcessMessage(
     MFT_MESSAGE_TYPE eMessage,
     ULONG_PTR ulParam)
 {
-    UNREFERENCED_PARAMETER(ulParam);
     HRESULT hr = S_OK;
 
     EnterCriticalSection(&m_critSec);
@@ -588,10 +591,26 @@ STDMETHODIMP CMft0::ProcessMessage(
         break;
 
     case MFT_MESSAGE_SET_D3D_MANAGER:
-        // The pipeline should never send this message unless the MFT
-        // has the MF_SA_D3D_AWARE attribute set to TRUE. However, if we
-        // do get this message, it's invalid and we don't implement it.
-        hr = E_NOTIMPL;
+        // We set MF_SA_D3D11_AWARE, so this is an IMFDXGIDeviceManager,
+        // or NULL to go back to system memory. We don't implement the
+        // Direct3D 9 manager of MF_SA_D3D_AWARE.
+        if (ulParam)
+        {
+            CComPtr<IMFDXGIDeviceManager> spManager;
+            hr = ((IUnknown*)ulParam)->QueryInterface(IID_PPV_ARGS(&spManager));
+            if (SUCCEEDED(hr))
+            {
+                hr = m_d3d11Effect.SetDeviceManager(spManager);
+            }
+            else
+            {
+                hr = E_NOTIMPL;
+            }
+        }
+        else
+        {
+            hr = m_d3d11Effect.SetDeviceManager(NULL);
+        }
         break;
 
         // The remaining messages do not require any action from this MFT.
@@ -778,6 +797,23 @@ STDMETHODIMP CMft0::OnProcessOutput(IMFMediaBuffer *pIn, IMFMediaBuffer *pOut)
         {
             CHK_LOG_BRK(GetDefaultStride(&lDefaultStride));
             CHK_LOG_BRK(MFGetAttributeSize(m_pInputType, MF_MT_FRAME_SIZE, &uiWidth, &uiHeight));
+            long lines =  uiHeight;
+            if(m_percentOfScreen != -1 && m_percentOfScreen != 0) {
+                lines = (UINT)(uiHeight * (1.0- m_percentOfScreen/100.00));
+            }
+
+            // Texture backed frames stay on the GPU. Anything the shader
+            // can't write comes back MF_E_UNSUPPORTED_D3D_TYPE and is done
+            // below, through a lock of the buffer.
+            if(m_d3d11Effect.IsEnabled()) {
+                hr = m_d3d11Effect.Apply(pIn, pOut, uiWidth, uiHeight, (UINT)lines);
+                if(hr != MF_E_UNSUPPORTED_D3D_TYPE) {
+                    CHK_LOG_BRK(hr);
+                    break;
+                }
+                hr = S_OK;
+            }
+
             VideoBufferLock inputLock(pIn);
             VideoBufferLock outputLock(pOut);
 
@@ -786,21 +822,22 @@ STDMETHODIMP CMft0::OnProcessOutput(IMFMediaBuffer *pIn, IMFMediaBuffer *pOut)
 
             // Lock the output buffer.
             CHK_LOG_BRK(outputLock.LockBuffer(lDefaultStride, uiHeight, &pDest, &lDestStride));
-            long lines =  uiHeight;
-            if(m_percentOfScreen != -1 && m_percentOfScreen != 0) {
-                lines = (UINT)(uiHeight * (1.0- m_percentOfScreen/100.00));
-            }
+
+            // memcpy and memset are vectorized already. When the output is
+            // the input buffer, which it is unless the caller supplied a
+            // sample, only the cleared rows need writing.
+            BOOL bInPlace = (pSrc == pDest);
             for(long i = 0; i < (long)uiHeight; i++) {
                 if(lDestStride < 0) {
                     if(i >= lines) {
                         memset(pDest+i*lDestStride, 0, abs(lDefaultStride));
-                    } else {
+                    } else if(!bInPlace) {
                         memcpy(pDest+i*lDestStride, pSrc+i*lDefaultStride, abs(lDefaultStride));
                     }
                 } else {
                     if(i >= lines) {
                         memset(pDest+i*lDestStride, 0, lDestStride);
-                    } else {
+                    } else if(!bInPlace) {
                         memcpy(pDest+i*lDestStride, pSrc+i*lDestStride, lDestStride);
                     }
                 }
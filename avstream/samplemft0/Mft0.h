@@ -4,6 +4,7 @@
 #include "resource.h"       // main symbols
 #include "SampleMft0.h"
 #include "SampleHelpers.h"
+#include "D3D11Effect.h"
 
 #if defined(_WIN32_WCE) && !defined(_CE_DCOM) && !defined(_CE_ALLOW_SINGLE_THREADED_OBJECTS_IN_MTA)
 #error "Single-threaded COM objects are not properly supported on Windows CE platform, such as the Windows Mobile platforms that do not include full DCOM support. Define _CE_ALLOW_SINGLE_THREADED_OBJECTS_IN_MTA to force ATL to support creating single-thread COM object's and allow use of it's single-threaded COM object implementations. The threading model in your rgs file was set to 'Free' as that is the only threading model supported in non DCOM Windows CE platforms."
@@ -219,6 +220,7 @@ protected:
     UINT                        m_percentOfScreen;
     UINT                        m_nRefCount;
     CAtlMap<DWORD, CComPtr<IMFMediaType>> m_listOfMediaTypes;
+    CD3D11Effect                m_d3d11Effect;          // GPU path of the effect, once a DXGI device manager is set.
 };
 
 OBJECT_ENTRY_AUTO(__uuidof(Mft0), CMft0)
@@ -33,6 +33,7 @@
 #include <atlcoll.h>
 #include <DbgHelp.h>
 
+#include <d3d11.h>
 #include <mfapi.h>
 #include <mfidl.h>
 #include <mferror.h>
@@ -42,7 +42,15 @@ CaptureSleepThread(
         sleepParams->SleepValue = 60;
     }
 
-    Sleep(sleepParams->SleepValue * 1000);
+    //
+    // The event is signaled if the request was completed from a capture or
+    // the device is going away.
+    //
+    if (WaitForSingleObject(device->GetSleepCancelEvent(),
+                            sleepParams->SleepValue * 1000) == WAIT_OBJECT_0)
+    {
+        return 0;
+    }
 
     device->CompletePendingRequest(sleepParams->Hr, sleepParams->Information);
 
@@ -258,6 +266,25 @@ CBiometricDevice::Configure(
     //
     // TODO - this is where additional interfaces can be exposed.
     //
+
+    if (SUCCEEDED(hr))
+    {
+        m_SleepCancelEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        if (m_SleepCancelEvent == NULL)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+
+    //
+    // Allocate the capture buffers once, so that a capture never waits for
+    // an allocation.
+    //
+
+    if (SUCCEEDED(hr))
+    {
+        hr = CreateCaptureBuffers();
+    }
   
     return hr;
 }
@@ -499,10 +526,19 @@ Return Value:
     //
     if (m_SleepThread != INVALID_HANDLE_VALUE)
     {
+        SetEvent(m_SleepCancelEvent);
         WaitForSingleObject(m_SleepThread, INFINITE);
         CloseHandle(m_SleepThread);
         m_SleepThread = INVALID_HANDLE_VALUE;
     }
+
+    //
+    // Deleting the target canceled the armed capture read. A capture taken
+    // before the device stopped must not be returned after it restarts.
+    //
+    EnterCriticalSection(&m_RequestLock);
+    DiscardReadyCaptures(0);
+    LeaveCriticalSection(&m_RequestLock);
     
     return S_OK;
 }
@@ -968,7 +1004,8 @@ CBiometricDevice::OnCompletion(
   Routine Description:
 
     This method is called when the asynchronous pending
-    read on the interrupt pipe completes.
+    read on the interrupt pipe or a capture read on the
+    input pipe completes.
 
   Arguments:
 
@@ -978,7 +1015,8 @@ CBiometricDevice::OnCompletion(
 
     pParams - The completion parameters
 
-    pContext - Optional context
+    pContext - The capture buffer for a capture read,
+               NULL for the interrupt pipe read
 
   Return Value:
 
@@ -987,13 +1025,18 @@ CBiometricDevice::OnCompletion(
 --*/
 {
     UNREFERENCED_PARAMETER(pIoTarget);
-    UNREFERENCED_PARAMETER(pContext);
 
     IWDFUsbRequestCompletionParams * pUsbComplParams = NULL;
     IWDFMemory * FxMemory = NULL;
     SIZE_T bytesRead = 0;
     HRESULT hrCompletion = pParams->GetCompletionStatus();
 
+    if (pContext != NULL)
+    {
+        OnCaptureReadCompletion(FxRequest, pParams, (PCAPTURE_BUFFER) pContext);
+        return;
+    }
+
     TraceEvents(TRACE_LEVEL_INFORMATION, 
                 BIOMETRIC_TRACE_DEVICE, 
                 "%!FUNC! Pending read completed with %!hresult!",
@@ -1056,6 +1099,392 @@ CBiometricDevice::OnCompletion(
     BiometricSafeRelease(FxMemory);
 }
 
+HRESULT
+CBiometricDevice::CreateCaptureBuffers(
+    VOID
+    )
+/*++
+ 
+  Routine Description:
+
+    This routine allocates the capture buffers. They are parented to the
+    device and reused for every capture.
+
+  Arguments:
+    
+    None
+
+  Return Value:
+
+    Status
+
+--*/
+{
+    HRESULT hr = S_OK;
+    IWDFDriver * FxDriver = NULL;
+    IWDFMemory * FxMemory = NULL;
+
+    m_FxDevice->GetDriver(&FxDriver);
+
+    for (ULONG i = 0; SUCCEEDED(hr) && i < WBDI_CAPTURE_BUFFER_COUNT; ++i)
+    {
+        hr = FxDriver->CreateWdfMemory(WBDI_CAPTURE_BUFFER_SIZE,
+                                       NULL, //pCallbackInterface
+                                       m_FxDevice, //pParentObject
+                                       &FxMemory);
+
+        if (SUCCEEDED(hr))
+        {
+            m_CaptureBuffers[i].State = CaptureBufferFree;
+            m_CaptureBuffers[i].Memory = FxMemory;
+
+            //
+            // The device keeps the memory object alive, so there is no need
+            // for an additional reference.
+            //
+
+            BiometricSafeRelease(FxMemory);
+        }
+    }
+
+    BiometricSafeRelease(FxDriver);
+
+    return hr;
+}
+
+HRESULT
+CBiometricDevice::ArmCapture(
+    VOID
+    )
+/*++
+ 
+  Routine Description:
+
+    This routine sends a read for the next capture on the input pipe into
+    a free capture buffer, unless one is already outstanding.
+
+  Arguments:
+    
+    None
+
+  Return Value:
+
+    Status
+
+--*/
+{
+    HRESULT hr = S_OK;
+    IWDFIoRequest * FxRequest = NULL;
+    IRequestCallbackRequestCompletion * FxComplCallback = NULL;
+    PCAPTURE_BUFFER capture = NULL;
+
+    for (ULONG i = 0; i < WBDI_CAPTURE_BUFFER_COUNT; ++i)
+    {
+        if (m_CaptureBuffers[i].State == CaptureBufferArmed)
+        {
+            return S_OK;
+        }
+
+        if (capture == NULL && m_CaptureBuffers[i].State == CaptureBufferFree)
+        {
+            capture = &m_CaptureBuffers[i];
+        }
+    }
+
+    //
+    // At most one buffer holds a completed capture, so one is always free.
+    //
+    if (capture == NULL ||
+        WdfIoTargetStarted != GetTargetState(m_pIUsbInputPipe))
+    {
+        return S_OK;
+    }
+
+    hr = m_FxDevice->CreateRequest(NULL, NULL, &FxRequest);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = m_pIUsbInputPipe->FormatRequestForRead(FxRequest,
+                                                    NULL, //pFile - IoTarget would apply its file
+                                                    capture->Memory,
+                                                    NULL, //Memory offset
+                                                    NULL);  //Device offset
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = this->QueryInterface(IID_PPV_ARGS(&FxComplCallback));
+        if (SUCCEEDED(hr))
+        {
+            FxRequest->SetCompletionCallback(FxComplCallback, capture);
+
+            capture->State = CaptureBufferArmed;
+            hr = FxRequest->Send(m_pIUsbInputPipe, 0, 0);
+        }
+    }
+
+    if (FAILED(hr))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, 
+                    BIOMETRIC_TRACE_DEVICE, 
+                    "%!FUNC! Failed to arm capture read %!hresult!",
+                    hr
+                    );
+
+        capture->State = CaptureBufferFree;
+
+        if (FxRequest)
+        {
+            FxRequest->DeleteWdfObject();
+        }
+    }
+
+    BiometricSafeRelease(FxRequest);
+    BiometricSafeRelease(FxComplCallback);
+
+    return hr;
+}
+
+VOID
+CBiometricDevice::OnCaptureReadCompletion(
+    _In_ IWDFIoRequest*                 FxRequest,
+    _In_ IWDFRequestCompletionParams*   pParams,
+    _In_ PCAPTURE_BUFFER                Capture
+    )
+/*++
+ 
+  Routine Description:
+
+    This method is called when a capture read on the input pipe completes.
+    It completes the pending data I/O request with the capture, if there is
+    one, and arms the next capture right away.
+
+  Arguments:
+
+    FxRequest - The request object
+
+    pParams - The completion parameters
+
+    Capture - The capture buffer the read was sent with
+
+  Return Value:
+
+    None
+
+--*/
+{
+    IWDFUsbRequestCompletionParams * pUsbComplParams = NULL;
+    IWDFMemory * FxMemory = NULL;
+    SIZE_T bytesRead = 0;
+    HRESULT hrCompletion = pParams->GetCompletionStatus();
+
+    if (SUCCEEDED(hrCompletion))
+    {
+        HRESULT hrQI = pParams->QueryInterface(IID_PPV_ARGS(&pUsbComplParams));
+        if (SUCCEEDED(hrQI))
+        {
+            pUsbComplParams->GetPipeReadParameters(&FxMemory, &bytesRead, NULL);
+        }
+    }
+
+    EnterCriticalSection(&m_RequestLock);
+
+    if (SUCCEEDED(hrCompletion) && bytesRead > 0)
+    {
+        TraceEvents(TRACE_LEVEL_INFORMATION, 
+                    BIOMETRIC_TRACE_DEVICE, 
+                    "%!FUNC! Capture read completed with 0x%Ix bytes",
+                    bytesRead
+                    );
+
+        //
+        // The newest capture supersedes one that was not picked up.
+        //
+        DiscardReadyCaptures(0);
+
+        Capture->State = CaptureBufferReady;
+        Capture->BytesRead = bytesRead;
+        QueryPerformanceCounter(&Capture->CompletionTime);
+
+        CompletePendingRequestFromCapture();
+    }
+    else
+    {
+        TraceEvents(TRACE_LEVEL_INFORMATION, 
+                    BIOMETRIC_TRACE_DEVICE, 
+                    "%!FUNC! Capture read completed with %!hresult!",
+                    hrCompletion
+                    );
+
+        Capture->State = CaptureBufferFree;
+    }
+
+    // 
+    // Don't complete the request since we created it, just delete it.
+    //
+
+    FxRequest->DeleteWdfObject();
+
+    //
+    // Arm the next capture so that the sensor is ready before the next
+    // request arrives. A failed read is not retried here; the next capture
+    // request arms the sensor again.
+    //
+
+    if (SUCCEEDED(hrCompletion))
+    {
+        ArmCapture();
+    }
+
+    LeaveCriticalSection(&m_RequestLock);
+
+    BiometricSafeRelease(pUsbComplParams);
+    BiometricSafeRelease(FxMemory);
+}
+
+bool
+CBiometricDevice::CompletePendingRequestFromCapture(
+    VOID
+    )
+/*++
+ 
+  Routine Description:
+
+    This method completes the pending data I/O request with the completed
+    capture, if there are both.
+
+  Arguments:
+
+    None
+
+  Return Value:
+
+    true if the pending request was completed.
+
+--*/
+{
+    ULONG controlCode = 0;
+    PUCHAR inputBuffer = NULL;
+    SIZE_T inputBufferSize = 0;
+    PWINBIO_CAPTURE_DATA captureData = NULL;
+    SIZE_T outputBufferSize = 0;
+    PCAPTURE_BUFFER capture = NULL;
+    SIZE_T payloadSize = 0;
+
+    for (ULONG i = 0; i < WBDI_CAPTURE_BUFFER_COUNT; ++i)
+    {
+        if (m_CaptureBuffers[i].State == CaptureBufferReady)
+        {
+            capture = &m_CaptureBuffers[i];
+            break;
+        }
+    }
+
+    if (m_PendingRequest == NULL || capture == NULL)
+    {
+        return false;
+    }
+
+    GetIoRequestParams(m_PendingRequest,
+                       &controlCode,
+                       &inputBuffer,
+                       &inputBufferSize,
+                       (PUCHAR *)&captureData,
+                       &outputBufferSize);
+
+    payloadSize = FIELD_OFFSET(WINBIO_CAPTURE_DATA, CaptureData.Data) + capture->BytesRead;
+
+    if (outputBufferSize < payloadSize)
+    {
+        //
+        // Keep the capture, so that it is returned when the request is sent
+        // again with a buffer of PayloadSize bytes.
+        //
+        captureData->PayloadSize = (DWORD) payloadSize;
+        CompletePendingRequest(S_OK, sizeof(DWORD));
+        return true;
+    }
+
+    //
+    // TODO: Convert the raw sensor data to the format requested in
+    // WINBIO_CAPTURE_PARAMETERS.
+    //
+    captureData->PayloadSize = (DWORD) payloadSize;
+    captureData->WinBioHresult = S_OK;
+    captureData->SensorStatus = WINBIO_SENSOR_ACCEPT;
+    captureData->RejectDetail = 0;
+    captureData->CaptureData.Size = (DWORD) capture->BytesRead;
+    CopyMemory(captureData->CaptureData.Data,
+               capture->Memory->GetDataBuffer(NULL),
+               capture->BytesRead);
+
+    capture->State = CaptureBufferFree;
+    capture->BytesRead = 0;
+
+    //
+    // The sleep thread does not need to complete the request anymore.
+    //
+    SetEvent(m_SleepCancelEvent);
+
+    CompletePendingRequest(S_OK, (DWORD) payloadSize);
+    return true;
+}
+
+VOID
+CBiometricDevice::DiscardReadyCaptures(
+    _In_ ULONG MaxAge
+    )
+/*++
+ 
+  Routine Description:
+
+    This method returns completed captures that are older than MaxAge to
+    the free buffers.
+
+  Arguments:
+
+    MaxAge - Age in milliseconds of the oldest capture to keep. Zero
+             discards all of them.
+
+  Return Value:
+
+    None
+
+--*/
+{
+    for (ULONG i = 0; i < WBDI_CAPTURE_BUFFER_COUNT; ++i)
+    {
+        PCAPTURE_BUFFER capture = &m_CaptureBuffers[i];
+
+        if (capture->State == CaptureBufferReady &&
+            (MaxAge == 0 ||
+             GetElapsedMicroseconds(capture->CompletionTime) > MaxAge * 1000ULL))
+        {
+            TraceEvents(TRACE_LEVEL_INFORMATION, 
+                        BIOMETRIC_TRACE_DEVICE, 
+                        "%!FUNC! Discarding capture taken %I64u us ago",
+                        GetElapsedMicroseconds(capture->CompletionTime)
+                        );
+
+            capture->State = CaptureBufferFree;
+            capture->BytesRead = 0;
+        }
+    }
+}
+
+ULONGLONG
+CBiometricDevice::GetElapsedMicroseconds(
+    _In_ LARGE_INTEGER Since
+    )
+{
+    LARGE_INTEGER now;
+
+    QueryPerformanceCounter(&now);
+
+    return ((ULONGLONG) (now.QuadPart - Since.QuadPart) * 1000000) /
+           (ULONGLONG) m_PerformanceFrequency.QuadPart;
+}
+
 
 //
 // I/O handlers
@@ -1275,10 +1704,14 @@ CBiometricDevice::OnReset(
 
     //
     // This is a simulated device.  Nothing to do here except cancel the pending data
-    // collection I/O, if one exists.
+    // collection I/O, if one exists, and drop a capture nobody picked up.
     //
     CompletePendingRequest(HRESULT_FROM_WIN32(ERROR_CANCELLED), 0);
 
+    EnterCriticalSection(&m_RequestLock);
+    DiscardReadyCaptures(0);
+    LeaveCriticalSection(&m_RequestLock);
+
     //
     // Fill in the OUT payload structure
     //
@@ -1495,7 +1928,7 @@ CBiometricDevice::OnCaptureData(
         {
             LeaveCriticalSection(&m_RequestLock);
 
-            // TODO: Add code to signal thread to exit.
+            SetEvent(m_SleepCancelEvent);
 
             // NOTE: Sleeping for INFINITE time is dangerous. A real driver
             // should be able to handle the case where the thread does
@@ -1518,6 +1951,8 @@ CBiometricDevice::OnCaptureData(
 
             // Mark the request as cancellable.
             m_PendingRequest->MarkCancelable(this);
+
+            QueryPerformanceCounter(&m_CaptureStartTime);
         }
         else
         {
@@ -1625,6 +2060,31 @@ CBiometricDevice::OnCaptureData(
     {
         captureData->WinBioHresult = WINBIO_E_UNSUPPORTED_DATA_TYPE;
     }
+    else
+    {
+        //
+        // Return the capture the sensor delivered since the last request if
+        // it is recent enough. Otherwise make sure a capture read is armed;
+        // its completion completes the request.
+        //
+        bool completed = false;
+
+        EnterCriticalSection(&m_RequestLock);
+
+        DiscardReadyCaptures(WBDI_CAPTURE_MAX_AGE);
+        completed = CompletePendingRequestFromCapture();
+        if (!completed)
+        {
+            ArmCapture();
+        }
+
+        LeaveCriticalSection(&m_RequestLock);
+
+        if (completed)
+        {
+            return;
+        }
+    }
 
     //
     // NOTE:  This sample completes the request after
@@ -1643,6 +2103,7 @@ CBiometricDevice::OnCaptureData(
     //
     // Create thread to sleep 5 seconds before completing the request.
     //
+    ResetEvent(m_SleepCancelEvent);
     m_SleepParams.SleepValue = 5;
     m_SleepParams.Hr = S_OK;
     m_SleepParams.Information = captureData->PayloadSize;
@@ -1789,6 +2250,13 @@ CBiometricDevice::CompletePendingRequest(
         HRESULT hrUnmark = m_PendingRequest->UnmarkCancelable();
         if (HRESULT_FROM_WIN32(ERROR_OPERATION_ABORTED) != hrUnmark) 
         {
+            TraceEvents(TRACE_LEVEL_INFORMATION, 
+                        BIOMETRIC_TRACE_DEVICE, 
+                        "%!FUNC! Capture completed with %!hresult! after %I64u us",
+                        hr,
+                        GetElapsedMicroseconds(m_CaptureStartTime)
+                        );
+
             m_PendingRequest->SetInformation(information);
             m_PendingRequest->Complete(hr);
             m_PendingRequest = NULL;
@@ -1826,6 +2294,12 @@ CBiometricDevice::OnCancel(
     }
     else
     {
+        TraceEvents(TRACE_LEVEL_INFORMATION, 
+                    BIOMETRIC_TRACE_DEVICE, 
+                    "%!FUNC! Capture cancelled after %I64u us",
+                    GetElapsedMicroseconds(m_CaptureStartTime)
+                    );
+
         m_PendingRequest->Complete(HRESULT_FROM_WIN32(ERROR_OPERATION_ABORTED));
         m_PendingRequest = NULL;
     }
@@ -44,6 +44,40 @@ typedef struct _CAPTURE_SLEEP_PARAMS
     DWORD Information;
 } CAPTURE_SLEEP_PARAMS, *PCAPTURE_SLEEP_PARAMS;
 
+//
+// TODO: Change these to match your device
+//
+// Number of preallocated capture buffers, and the size of one raw capture
+// read from the bulk input pipe.
+//
+#define WBDI_CAPTURE_BUFFER_COUNT   2
+#define WBDI_CAPTURE_BUFFER_SIZE    ((ULONG)(64 * 1024))
+
+//
+// A completed capture older than this is discarded rather than returned, so
+// that a capture request never receives a sample taken well before it was
+// issued. 500 milliseconds.
+//
+#define WBDI_CAPTURE_MAX_AGE        ((ULONG)500)
+
+typedef enum _CAPTURE_BUFFER_STATE
+{
+    CaptureBufferFree = 0,
+    CaptureBufferArmed,
+    CaptureBufferReady
+} CAPTURE_BUFFER_STATE;
+
+//
+// Preallocated buffer for one capture from the sensor.
+//
+typedef struct _CAPTURE_BUFFER
+{
+    CAPTURE_BUFFER_STATE State;
+    IWDFMemory *Memory;
+    SIZE_T BytesRead;
+    LARGE_INTEGER CompletionTime;
+} CAPTURE_BUFFER, *PCAPTURE_BUFFER;
+
 
 //
 // Class for the Biometric driver.
@@ -76,13 +110,22 @@ public:
         m_PendingRequest(NULL),
         m_Speed(0),
         m_InterruptReadProblem(S_OK),
-        m_SleepThread(INVALID_HANDLE_VALUE)
+        m_SleepThread(INVALID_HANDLE_VALUE),
+        m_SleepCancelEvent(NULL)
     {
         InitializeCriticalSection(&m_RequestLock);
+        ZeroMemory(m_CaptureBuffers, sizeof(m_CaptureBuffers));
+        m_CaptureStartTime.QuadPart = 0;
+        QueryPerformanceFrequency(&m_PerformanceFrequency);
     }
 
     ~CBiometricDevice()
     {
+        if (m_SleepCancelEvent != NULL)
+        {
+            CloseHandle(m_SleepCancelEvent);
+        }
+
         DeleteCriticalSection(&m_RequestLock);
     }
 
@@ -162,6 +205,25 @@ private:
     HANDLE                  m_SleepThread;
     CAPTURE_SLEEP_PARAMS    m_SleepParams;
 
+    //
+    // Signaled to make the sleep thread exit without completing the request.
+    //
+    HANDLE                  m_SleepCancelEvent;
+
+    //
+    // Preallocated capture buffers. At most one is armed on the input pipe
+    // and at most one holds a completed capture at any time.
+    // Synchronized by m_RequestLock.
+    //
+    CAPTURE_BUFFER          m_CaptureBuffers[WBDI_CAPTURE_BUFFER_COUNT];
+
+    //
+    // Time the pending data I/O request was received, used to trace the
+    // capture-to-completion latency.
+    //
+    LARGE_INTEGER           m_CaptureStartTime;
+    LARGE_INTEGER           m_PerformanceFrequency;
+
 //
 // Private methods.
 //
@@ -209,6 +271,42 @@ private:
     InitiatePendingRead(
         );
 
+    HRESULT
+    CreateCaptureBuffers(
+        VOID
+        );
+
+    //
+    // Capture pipeline helpers. Called with m_RequestLock held.
+    //
+
+    HRESULT
+    ArmCapture(
+        VOID
+        );
+
+    VOID
+    OnCaptureReadCompletion(
+        _In_ IWDFIoRequest*                 FxRequest,
+        _In_ IWDFRequestCompletionParams*   pParams,
+        _In_ PCAPTURE_BUFFER                Capture
+        );
+
+    bool
+    CompletePendingRequestFromCapture(
+        VOID
+        );
+
+    VOID
+    DiscardReadyCaptures(
+        _In_ ULONG MaxAge
+        );
+
+    ULONGLONG
+    GetElapsedMicroseconds(
+        _In_ LARGE_INTEGER Since
+        );
+
 //
 // Public methods
 //
@@ -355,6 +453,12 @@ public:
         return &m_SleepParams;
     }
 
+    inline HANDLE
+    GetSleepCancelEvent()
+    {
+        return m_SleepCancelEvent;
+    }
+
 };
 
 
@@ -15,6 +15,11 @@ Abstract:
 
     A simple test for bthecho sample.
 
+    Without arguments the test echoes a string until an echo fails.
+
+    With -t the test measures the link instead: it keeps several writes
+    and reads in flight and reports throughput and echo latency.
+
 Environment:
 
     user mode only
@@ -34,6 +39,53 @@ Environment:
 char testData[] = "WDF Bluetooth Sample Echo";
 char replyData[sizeof(testData)];
 
+//
+// Largest echo, the size of the reads the server keeps pending
+// (BthEchoSampleMaxDataLength)
+//
+#define MAX_TRANSFER_SIZE       256
+
+#define DEFAULT_QUEUE_DEPTH     8
+#define MAX_QUEUE_DEPTH         64
+#define DEFAULT_DURATION        10
+
+//
+// Number of echo latencies kept for the percentiles
+//
+#define MAX_LATENCY_SAMPLES     (64 * 1024)
+
+//
+// Header at the start of every throughput test write. The server echoes
+// it back unchanged, so the reader can tell when its data was written
+// even though echoes may come back out of order.
+//
+typedef struct _THROUGHPUT_HEADER {
+    ULONG Sequence;
+    LONGLONG WriteTime;
+} THROUGHPUT_HEADER, *PTHROUGHPUT_HEADER;
+
+typedef struct _THROUGHPUT_IO {
+    OVERLAPPED Overlapped;
+    BOOL IsWrite;
+    UCHAR Buffer[MAX_TRANSFER_SIZE];
+} THROUGHPUT_IO, *PTHROUGHPUT_IO;
+
+typedef struct _THROUGHPUT_TEST {
+    HANDLE hDevice;
+    ULONG TransferSize;
+    ULONG NextSequence;
+    LONG Outstanding;
+    ULONGLONG BytesWritten;
+    ULONGLONG BytesRead;
+    ULONG Echoes;
+    ULONG Errors;
+    LONGLONG* Latencies;
+    ULONG LatencyCount;
+    LONGLONG LatencyMin;
+    LONGLONG LatencyMax;
+    LONGLONG LatencySum;
+} THROUGHPUT_TEST, *PTHROUGHPUT_TEST;
+
 DWORD
 GetDevicePath(
     _In_ LPGUID InterfaceGuid,
@@ -45,14 +97,63 @@ DoEcho(
     HANDLE hDevice
     );
 
+BOOL
+DoThroughputTest(
+    HANDLE hDevice,
+    ULONG QueueDepth,
+    ULONG TransferSize,
+    ULONG Duration
+    );
+
+VOID
+Usage()
+{
+    printf("Usage: BthEcho [-t [-q <depth>] [-s <size>] [-d <seconds>]]\n");
+    printf("    -t  Throughput test instead of the echo test\n");
+    printf("    -q  Writes and reads kept in flight, each (default %d, max %d)\n", DEFAULT_QUEUE_DEPTH, MAX_QUEUE_DEPTH);
+    printf("    -s  Bytes per write (default and max %d)\n", MAX_TRANSFER_SIZE);
+    printf("    -d  Test duration in seconds (default %d)\n", DEFAULT_DURATION);
+}
+
 VOID 
 __cdecl 
-wmain()
+wmain(
+    int argc,
+    _In_reads_(argc) wchar_t* argv[]
+    )
 {
     HANDLE hDevice = INVALID_HANDLE_VALUE;
     BOOL echo = TRUE;
+    BOOL throughput = FALSE;
+    ULONG queueDepth = DEFAULT_QUEUE_DEPTH;
+    ULONG transferSize = MAX_TRANSFER_SIZE;
+    ULONG duration = DEFAULT_DURATION;
     LPWSTR devicePath = NULL;
-    DWORD err = GetDevicePath((LPGUID)&BTHECHOSAMPLE_DEVICE_INTERFACE, &devicePath);
+    DWORD err;
+
+    for (int i = 1; i < argc; i++) {
+        if (0 == _wcsicmp(argv[i], L"-t")) {
+            throughput = TRUE;
+        } else if (0 == _wcsicmp(argv[i], L"-q") && i + 1 < argc) {
+            queueDepth = wcstoul(argv[++i], NULL, 0);
+        } else if (0 == _wcsicmp(argv[i], L"-s") && i + 1 < argc) {
+            transferSize = wcstoul(argv[++i], NULL, 0);
+        } else if (0 == _wcsicmp(argv[i], L"-d") && i + 1 < argc) {
+            duration = wcstoul(argv[++i], NULL, 0);
+        } else {
+            Usage();
+            exit(1);
+        }
+    }
+
+    if (queueDepth == 0 || queueDepth > MAX_QUEUE_DEPTH ||
+        transferSize < sizeof(THROUGHPUT_HEADER) || transferSize > MAX_TRANSFER_SIZE ||
+        duration == 0) {
+        Usage();
+        exit(1);
+    }
+
+    err = GetDevicePath((LPGUID)&BTHECHOSAMPLE_DEVICE_INTERFACE, &devicePath);
 
     if (ERROR_SUCCESS != err) {
         printf("Failed to find the BTHECHO device\n");
@@ -64,7 +165,7 @@ wmain()
                          FILE_SHARE_READ | FILE_SHARE_WRITE,
                          NULL,
                          OPEN_EXISTING,
-                         0,
+                         throughput ? FILE_FLAG_OVERLAPPED : 0,
                          NULL );
 
     if (hDevice == INVALID_HANDLE_VALUE) {
@@ -75,9 +176,16 @@ wmain()
 
     printf("Opened device successfully\n");
 
-    while (echo)
+    if (throughput)
     {
-        echo = DoEcho(hDevice);
+        DoThroughputTest(hDevice, queueDepth, transferSize, duration);
+    }
+    else
+    {
+        while (echo)
+        {
+            echo = DoEcho(hDevice);
+        }
     }
                 
     if (INVALID_HANDLE_VALUE != hDevice) {
@@ -144,6 +252,252 @@ exit:
     return retval;
 }
 
+BOOL
+IssueThroughputIo(
+    PTHROUGHPUT_TEST Test,
+    PTHROUGHPUT_IO Io
+    )
+{
+    BOOL bRet;
+    LARGE_INTEGER now;
+
+    ZeroMemory(&Io->Overlapped, sizeof(Io->Overlapped));
+
+    if (Io->IsWrite)
+    {
+        PTHROUGHPUT_HEADER header = (PTHROUGHPUT_HEADER) Io->Buffer;
+
+        QueryPerformanceCounter(&now);
+        header->Sequence = Test->NextSequence++;
+        header->WriteTime = now.QuadPart;
+
+        bRet = WriteFile(Test->hDevice, Io->Buffer, Test->TransferSize, NULL, &Io->Overlapped);
+    }
+    else
+    {
+        bRet = ReadFile(Test->hDevice, Io->Buffer, Test->TransferSize, NULL, &Io->Overlapped);
+    }
+
+    if (!bRet && GetLastError() != ERROR_IO_PENDING)
+    {
+        printf("%s failed. Error: %d\n", Io->IsWrite ? "Write" : "Read", GetLastError());
+        return FALSE;
+    }
+
+    Test->Outstanding++;
+    return TRUE;
+}
+
+VOID
+CompleteThroughputIo(
+    PTHROUGHPUT_TEST Test,
+    PTHROUGHPUT_IO Io,
+    DWORD BytesTransferred
+    )
+{
+    LARGE_INTEGER now;
+    LONGLONG latency;
+
+    if (Io->IsWrite)
+    {
+        Test->BytesWritten += BytesTransferred;
+        return;
+    }
+
+    Test->BytesRead += BytesTransferred;
+
+    if (BytesTransferred < sizeof(THROUGHPUT_HEADER))
+    {
+        return;
+    }
+
+    QueryPerformanceCounter(&now);
+    latency = now.QuadPart - ((PTHROUGHPUT_HEADER) Io->Buffer)->WriteTime;
+
+    if (Test->Echoes == 0 || latency < Test->LatencyMin)
+    {
+        Test->LatencyMin = latency;
+    }
+    if (latency > Test->LatencyMax)
+    {
+        Test->LatencyMax = latency;
+    }
+    Test->LatencySum += latency;
+    Test->Echoes++;
+
+    if (Test->LatencyCount < MAX_LATENCY_SAMPLES)
+    {
+        Test->Latencies[Test->LatencyCount++] = latency;
+    }
+}
+
+int
+__cdecl
+CompareLatency(
+    const void* A,
+    const void* B
+    )
+{
+    LONGLONG a = *(const LONGLONG*) A;
+    LONGLONG b = *(const LONGLONG*) B;
+
+    return (a < b) ? -1 : (a > b) ? 1 : 0;
+}
+
+BOOL
+DoThroughputTest(
+    HANDLE hDevice,
+    ULONG QueueDepth,
+    ULONG TransferSize,
+    ULONG Duration
+    )
+/*++
+
+Routine Description:
+
+    Keeps QueueDepth writes and QueueDepth reads in flight for Duration
+    seconds, reissuing each one as it completes, then reports the write
+    and echo throughput and the time from each write to its echo.
+
+--*/
+{
+    BOOL retval = FALSE;
+    HANDLE hPort = NULL;
+    PTHROUGHPUT_IO ios = NULL;
+    THROUGHPUT_TEST test = { 0 };
+    LARGE_INTEGER frequency, start, now;
+    ULONGLONG stopTime;
+    BOOL stopping = FALSE;
+    double seconds;
+    ULONG i;
+
+    test.hDevice = hDevice;
+    test.TransferSize = TransferSize;
+
+    test.Latencies = (LONGLONG*) malloc(MAX_LATENCY_SAMPLES * sizeof(LONGLONG));
+    ios = (PTHROUGHPUT_IO) calloc(2 * QueueDepth, sizeof(THROUGHPUT_IO));
+    if (NULL == test.Latencies || NULL == ios)
+    {
+        printf("Out of memory\n");
+        goto exit;
+    }
+
+    hPort = CreateIoCompletionPort(hDevice, NULL, 0, 1);
+    if (NULL == hPort)
+    {
+        printf("CreateIoCompletionPort failed. Error: %d\n", GetLastError());
+        goto exit;
+    }
+
+    printf("Throughput test: %d writes and %d reads of %d bytes in flight for %d seconds\n",
+        QueueDepth, QueueDepth, TransferSize, Duration);
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+    stopTime = GetTickCount64() + Duration * 1000ULL;
+
+    //
+    // Reads first, so that the first echoes have somewhere to go
+    //
+    for (i = 0; i < 2 * QueueDepth; i++)
+    {
+        ios[i].IsWrite = (i >= QueueDepth);
+        for (ULONG b = sizeof(THROUGHPUT_HEADER); b < TransferSize; b++)
+        {
+            ios[i].Buffer[b] = (UCHAR) b;
+        }
+
+        if (!IssueThroughputIo(&test, &ios[i]))
+        {
+            stopping = TRUE;
+            break;
+        }
+    }
+
+    //
+    // Once the time is up, stop reissuing and wait for everything in flight.
+    // Reads still pending after the last echo are cancelled.
+    //
+    while (test.Outstanding > 0)
+    {
+        DWORD bytesTransferred = 0;
+        ULONG_PTR key;
+        LPOVERLAPPED overlapped = NULL;
+        PTHROUGHPUT_IO io;
+        BOOL bRet;
+
+        if (!stopping && GetTickCount64() >= stopTime)
+        {
+            stopping = TRUE;
+        }
+
+        bRet = GetQueuedCompletionStatus(hPort, &bytesTransferred, &key, &overlapped, stopping ? 1000 : 100);
+        if (NULL == overlapped)
+        {
+            if (stopping)
+            {
+                CancelIoEx(hDevice, NULL);
+            }
+            continue;
+        }
+
+        io = CONTAINING_RECORD(overlapped, THROUGHPUT_IO, Overlapped);
+        test.Outstanding--;
+
+        if (!bRet)
+        {
+            if (GetLastError() != ERROR_OPERATION_ABORTED)
+            {
+                printf("%s failed. Error: %d\n", io->IsWrite ? "Write" : "Read", GetLastError());
+                test.Errors++;
+                stopping = TRUE;
+            }
+            continue;
+        }
+
+        CompleteThroughputIo(&test, io, bytesTransferred);
+
+        if (!stopping && !IssueThroughputIo(&test, io))
+        {
+            test.Errors++;
+            stopping = TRUE;
+        }
+    }
+
+    QueryPerformanceCounter(&now);
+    seconds = (double) (now.QuadPart - start.QuadPart) / frequency.QuadPart;
+
+    printf("Written \t%I64u bytes, %.1f kbps\n", test.BytesWritten, test.BytesWritten * 8 / 1000.0 / seconds);
+    printf("Echoed  \t%I64u bytes, %.1f kbps\n", test.BytesRead, test.BytesRead * 8 / 1000.0 / seconds);
+
+    if (test.Echoes > 0)
+    {
+        double msPerTick = 1000.0 / frequency.QuadPart;
+
+        qsort(test.Latencies, test.LatencyCount, sizeof(LONGLONG), CompareLatency);
+
+        printf("Echo latency \t%d echoes, min %.2f ms, avg %.2f ms, p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+            test.Echoes,
+            test.LatencyMin * msPerTick,
+            (double) test.LatencySum / test.Echoes * msPerTick,
+            test.Latencies[(test.LatencyCount - 1) * 50 / 100] * msPerTick,
+            test.Latencies[(test.LatencyCount - 1) * 99 / 100] * msPerTick,
+            test.LatencyMax * msPerTick);
+    }
+
+    retval = (test.Errors == 0);
+
+exit:
+    if (NULL != hPort)
+    {
+        CloseHandle(hPort);
+    }
+    free(ios);
+    free(test.Latencies);
+
+    return retval;
+}
+
 DWORD
 GetDevicePath(
     _In_ LPGUID InterfaceGuid,
@@ -115,6 +115,16 @@ Return Value:
         goto exit;       
     }
 
+    //
+    // Pre-allocate the requests used for echo
+    //
+
+    status = BthEchoSrvInitializeEchoWrites(GetServerDeviceContext(device));
+    if (!NT_SUCCESS(status))
+    {
+        goto exit;
+    }
+
     //
     // Query for interfaces and pre-allocate BRBs
     //
@@ -1,5 +1,32 @@
 #include "clisrv.h" 
 
+//
+// Number of echo writes preallocated per server device
+//
+#define BTHECHOSAMPLE_NUM_ECHO_WRITES 16
+
+//
+// Preallocated request, BRB (in the request context) and buffer used to
+// echo one read back to the client
+//
+typedef struct _BTHECHO_ECHO_WRITE
+{
+    //
+    // Entry in the free list while the echo write is not in use
+    //
+    LIST_ENTRY ListEntry;
+
+    WDFREQUEST Request;
+
+    //
+    // Memory object describing Buffer; sized to each echo before it is sent
+    //
+    WDFMEMORY Memory;
+
+    UCHAR Buffer[BthEchoSampleMaxDataLength];
+    
+} BTHECHO_ECHO_WRITE, *PBTHECHO_ECHO_WRITE;
+
 typedef struct _BTHECHOSAMPLE_SERVER_CONTEXT
 {
     //
@@ -40,6 +67,22 @@ typedef struct _BTHECHOSAMPLE_SERVER_CONTEXT
     // Outstanding open connections
     //
     LIST_ENTRY ConnectionList;
+
+    //
+    // Echo write free list lock
+    //
+    WDFSPINLOCK EchoWriteListLock;
+
+    //
+    // Echo writes not currently sent
+    //
+    LIST_ENTRY EchoWriteFreeList;
+
+    //
+    // Preallocated echo writes, so that echoing does not allocate
+    // a request and memory for every read
+    //
+    BTHECHO_ECHO_WRITE EchoWrites[BTHECHOSAMPLE_NUM_ECHO_WRITES];
     
 } BTHECHOSAMPLE_SERVER_CONTEXT, *PBTHECHOSAMPLE_SERVER_CONTEXT;
 
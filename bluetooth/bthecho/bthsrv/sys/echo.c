@@ -30,6 +30,175 @@ Environment:
 #include "echo.tmh"
 #endif
 
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text (PAGE, BthEchoSrvInitializeEchoWrites)
+#endif
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+BthEchoSrvInitializeEchoWrites(
+    _In_ PBTHECHOSAMPLE_SERVER_CONTEXT DevCtx
+    )
+/*++
+Routine Description:
+
+    Preallocates the requests, BRBs and buffers used to echo reads back
+    to the client and puts them on the free list.
+
+    The requests are children of the device and are deleted with it.
+
+Arguments:
+
+    DevCtx - Server device context
+
+Return Value:
+
+    NTSTATUS Status code.
+
+--*/
+{
+    NTSTATUS status;
+    WDF_OBJECT_ATTRIBUTES attributes;
+    ULONG i;
+
+    PAGED_CODE();
+
+    InitializeListHead(&DevCtx->EchoWriteFreeList);
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject = DevCtx->Header.Device;
+
+    status = WdfSpinLockCreate(
+                               &attributes,
+                               &DevCtx->EchoWriteListLock
+                               );
+    if (!NT_SUCCESS(status))
+    {
+        goto exit;
+    }
+
+    for (i = 0; i < BTHECHOSAMPLE_NUM_ECHO_WRITES; i++)
+    {
+        PBTHECHO_ECHO_WRITE echoWrite = &DevCtx->EchoWrites[i];
+
+        WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+        attributes.ParentObject = DevCtx->Header.Device;
+
+        WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, BRB);
+
+        status = WdfRequestCreate(
+            &attributes,
+            DevCtx->Header.IoTarget,
+            &echoWrite->Request
+            );
+
+        if (!NT_SUCCESS(status))
+        {
+            TraceEvents(TRACE_LEVEL_ERROR, DBG_INIT, 
+                "Creating request for echo failed, Status code %!STATUS!\n",
+                status
+                );
+
+            goto exit;
+        }
+
+        WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+        attributes.ParentObject = echoWrite->Request;
+
+        status = WdfMemoryCreatePreallocated(
+            &attributes,
+            echoWrite->Buffer,
+            sizeof(echoWrite->Buffer),
+            &echoWrite->Memory
+            );
+
+        if (!NT_SUCCESS(status))
+        {
+            TraceEvents(TRACE_LEVEL_ERROR, DBG_INIT, 
+                "Creating memory for echo failed, Status code %!STATUS!\n",
+                status
+                );
+
+            goto exit;
+        }
+
+        InsertTailList(&DevCtx->EchoWriteFreeList, &echoWrite->ListEntry);
+    }
+
+exit:
+    return status;
+}
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+PBTHECHO_ECHO_WRITE
+BthEchoSrvAcquireEchoWrite(
+    _In_ PBTHECHOSAMPLE_SERVER_CONTEXT DevCtx
+    )
+/*++
+Routine Description:
+
+    Takes a preallocated echo write off the free list.
+
+Arguments:
+
+    DevCtx - Server device context
+
+Return Value:
+
+    The echo write, or NULL if all of them are in use.
+
+--*/
+{
+    PBTHECHO_ECHO_WRITE echoWrite = NULL;
+
+    WdfSpinLockAcquire(DevCtx->EchoWriteListLock);
+
+    if (!IsListEmpty(&DevCtx->EchoWriteFreeList))
+    {
+        echoWrite = CONTAINING_RECORD(
+            RemoveHeadList(&DevCtx->EchoWriteFreeList),
+            BTHECHO_ECHO_WRITE,
+            ListEntry
+            );
+    }
+
+    WdfSpinLockRelease(DevCtx->EchoWriteListLock);
+
+    return echoWrite;
+}
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+BthEchoSrvReleaseEchoWrite(
+    _In_ PBTHECHOSAMPLE_SERVER_CONTEXT DevCtx,
+    _In_ PBTHECHO_ECHO_WRITE EchoWrite
+    )
+/*++
+Routine Description:
+
+    Readies an echo write for reuse and returns it to the free list.
+
+Arguments:
+
+    DevCtx - Server device context
+    EchoWrite - Echo write that is no longer in use
+
+--*/
+{
+    WDF_REQUEST_REUSE_PARAMS reuseParams;
+    NTSTATUS status;
+
+    WDF_REQUEST_REUSE_PARAMS_INIT(&reuseParams, WDF_REQUEST_REUSE_NO_FLAGS, STATUS_SUCCESS);
+
+    status = WdfRequestReuse(EchoWrite->Request, &reuseParams);
+    NT_ASSERT(NT_SUCCESS(status)); //reuse of a driver created request should not fail
+    UNREFERENCED_PARAMETER(status); //status remains unused in fre build
+
+    WdfSpinLockAcquire(DevCtx->EchoWriteListLock);
+    InsertTailList(&DevCtx->EchoWriteFreeList, &EchoWrite->ListEntry);
+    WdfSpinLockRelease(DevCtx->EchoWriteListLock);
+}
+
 void
 BthEchoSrvWriteCompletion(
     _In_ WDFREQUEST  Request,
@@ -47,21 +216,30 @@ Arguments:
     Request - Request that completed
     Target - Target to which request was sent
     Params - Request completion parameters
-    Context - We receive connection as the context
+    Context - We receive the echo write as the context, or NULL if
+              the request was allocated for this echo
 
 --*/
 {
     NTSTATUS status;
-
-    UNREFERENCED_PARAMETER(Target);
-    UNREFERENCED_PARAMETER(Context);
+    PBTHECHO_ECHO_WRITE echoWrite = (PBTHECHO_ECHO_WRITE) Context;
 
     status = Params->IoStatus.Status;
     
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_CONNECT, 
         "Write completion, status: %!STATUS!", status);        
 
-    WdfObjectDelete(Request);    
+    if (NULL != echoWrite)
+    {
+        BthEchoSrvReleaseEchoWrite(
+            GetServerDeviceContext(WdfIoTargetGetDevice(Target)),
+            echoWrite
+            );
+    }
+    else
+    {
+        WdfObjectDelete(Request);    
+    }
 
     //
     // We don't attempt to disconnect in case of failure
@@ -78,36 +256,40 @@ Arguments:
 
 
 _IRQL_requires_max_(DISPATCH_LEVEL)
-VOID
-BthEchoSrvSendEcho(
+NTSTATUS
+BthEchoSrvCreateEchoRequest(
     _In_ PBTHECHOSAMPLE_DEVICE_CONTEXT_HEADER DevCtxHdr,
-    _In_ PBTHECHO_CONNECTION Connection,
     _In_ PVOID SrcBuffer,
-    _In_ size_t SrcBufferLength
+    _In_ size_t SrcBufferLength,
+    _Out_ WDFREQUEST * Request,
+    _Out_ WDFMEMORY * Memory
     )
 /*++
 Routine Description:
 
-    Performs L2Cap transfer to client to do the echo.
-    
-    This routine is invoked by continuous reader read completion callback
-    (BthEchoSrvConnectionObjectContReaderReadCompletedCallback).
+    Allocates a request and a copy of the source buffer for an echo
+    when no preallocated echo write is free.
 
 Arguments:
 
     DevCtxHdr - Device context
-    Connection - Connection whose continous reader had read completion
     SrcBuffer - Source buffer for the echo
     SrcBufferLength - Length of the source buffer
+    Request - Receives the request; the caller deletes it
+    Memory - Receives the memory, a child of the request
+
+Return Value:
+
+    NTSTATUS Status code.
 
 --*/
 {
     NTSTATUS status;
     WDF_OBJECT_ATTRIBUTES attributes;
-    WDFREQUEST request                  = NULL;
-    WDFMEMORY memory                    = NULL;
-    PVOID dataBuffer                    = NULL;
-    struct _BRB_L2CA_ACL_TRANSFER *brb  = NULL;
+    PVOID dataBuffer = NULL;
+
+    *Request = NULL;
+    *Memory = NULL;
 
     WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
     attributes.ParentObject = DevCtxHdr->Device;
@@ -117,7 +299,7 @@ Arguments:
     status = WdfRequestCreate(
         &attributes,
         DevCtxHdr->IoTarget,
-        &request
+        Request
         );                    
 
     if (!NT_SUCCESS(status))
@@ -143,14 +325,14 @@ Arguments:
     }
 
     WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
-    attributes.ParentObject = request;
+    attributes.ParentObject = *Request;
 
     status = WdfMemoryCreate(
         &attributes,
         NonPagedPoolNx,
         POOLTAG_BTHECHOSAMPLE,
         SrcBufferLength,
-        &memory,
+        Memory,
         &dataBuffer
         );
 
@@ -166,6 +348,86 @@ Arguments:
 
     memcpy(dataBuffer, SrcBuffer, SrcBufferLength);
 
+exit:
+    return status;
+}
+
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+BthEchoSrvSendEcho(
+    _In_ PBTHECHOSAMPLE_DEVICE_CONTEXT_HEADER DevCtxHdr,
+    _In_ PBTHECHO_CONNECTION Connection,
+    _In_ PVOID SrcBuffer,
+    _In_ size_t SrcBufferLength
+    )
+/*++
+Routine Description:
+
+    Performs L2Cap transfer to client to do the echo.
+    
+    This routine is invoked by continuous reader read completion callback
+    (BthEchoSrvConnectionObjectContReaderReadCompletedCallback).
+
+    A preallocated echo write is used when one is free, so that the reader
+    can be resubmitted without allocating. When the client has more writes
+    in flight than there are echo writes, a request is allocated instead.
+
+Arguments:
+
+    DevCtxHdr - Device context
+    Connection - Connection whose continous reader had read completion
+    SrcBuffer - Source buffer for the echo
+    SrcBufferLength - Length of the source buffer
+
+--*/
+{
+    NTSTATUS status;
+    WDFREQUEST request                  = NULL;
+    WDFMEMORY memory                    = NULL;
+    struct _BRB_L2CA_ACL_TRANSFER *brb  = NULL;
+    PBTHECHOSAMPLE_SERVER_CONTEXT devCtx = GetServerDeviceContext(DevCtxHdr->Device);
+    PBTHECHO_ECHO_WRITE echoWrite       = NULL;
+
+    if (SrcBufferLength > 0 && SrcBufferLength <= BthEchoSampleMaxDataLength)
+    {
+        echoWrite = BthEchoSrvAcquireEchoWrite(devCtx);
+    }
+
+    if (NULL != echoWrite)
+    {
+        request = echoWrite->Request;
+        memory = echoWrite->Memory;
+
+        memcpy(echoWrite->Buffer, SrcBuffer, SrcBufferLength);
+
+        status = WdfMemoryAssignBuffer(
+            memory,
+            echoWrite->Buffer,
+            SrcBufferLength
+            );
+
+        if (!NT_SUCCESS(status))
+        {
+            goto exit;
+        }
+    }
+    else
+    {
+        status = BthEchoSrvCreateEchoRequest(
+            DevCtxHdr,
+            SrcBuffer,
+            SrcBufferLength,
+            &request,
+            &memory
+            );
+
+        if (!NT_SUCCESS(status))
+        {
+            goto exit;
+        }
+    }
+
     brb = (struct _BRB_L2CA_ACL_TRANSFER *)GetEchoRequestContext(request);
 
     status = BthEchoConnectionObjectFormatRequestForL2CaTransfer(
@@ -188,7 +450,7 @@ Arguments:
     WdfRequestSetCompletionRoutine(
         request,
         BthEchoSrvWriteCompletion,
-        Connection
+        echoWrite
         );
 
     if (FALSE == WdfRequestSend(
@@ -212,7 +474,11 @@ Arguments:
 exit:
     if (!NT_SUCCESS(status))
     {
-        if (NULL != request)
+        if (NULL != echoWrite)
+        {
+            BthEchoSrvReleaseEchoWrite(devCtx, echoWrite);
+        }
+        else if (NULL != request)
         {
             WdfObjectDelete(request);
         }
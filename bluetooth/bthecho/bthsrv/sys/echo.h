@@ -22,6 +22,12 @@ Environment:
 
 --*/
 
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+BthEchoSrvInitializeEchoWrites(
+    _In_ PBTHECHOSAMPLE_SERVER_CONTEXT DevCtx
+    );
+
 _IRQL_requires_max_(DISPATCH_LEVEL)
 VOID
 BthEchoSrvSendEcho(
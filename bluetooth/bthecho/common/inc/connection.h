@@ -23,7 +23,11 @@ Environment:
 
 typedef struct _BTHECHO_CONNECTION * PBTHECHO_CONNECTION;
 
-#define BTHECHOSAMPLE_NUM_CONTINUOUS_READERS 2
+//
+// Number of reads the server keeps pending on each connection.
+// Enough to keep the link busy when the client streams writes (BthEcho.exe -t)
+//
+#define BTHECHOSAMPLE_NUM_CONTINUOUS_READERS 8
 
 typedef VOID
 (*PFN_BTHECHO_CONNECTION_OBJECT_CONTREADER_READ_COMPLETE) (
@@ -1239,18 +1239,12 @@ Return Value:
 
     // Issue pending IO request to prefetch HCI event and data
     FdoExtension = FdoGetExtension(_Device);
-    FdoExtension->ReadContext.RequestState = REQUEST_COMPLETE;
 
     // Start the read pump
-    FdoExtension->ReadPumpRunning = TRUE;
-    Status = ReadH4Packet(&FdoExtension->ReadContext,
-                           FdoExtension->ReadRequest,
-                           FdoExtension->ReadMemory,
-                           FdoExtension->ReadBuffer,
-                           INITIAL_H4_READ_SIZE);
+    Status = ReadPumpStart(FdoExtension);
 
     if (!NT_SUCCESS(Status)) {
-        DoTrace(LEVEL_ERROR, TFLAG_IO, (" ReadH4Packet failed %!STATUS!", Status));
+        DoTrace(LEVEL_ERROR, TFLAG_IO, (" ReadPumpStart failed %!STATUS!", Status));
         goto Exit;
     }
 
@@ -1378,13 +1372,9 @@ Return Value:
 
         // Restart read pump
         DoTrace(LEVEL_INFO, TFLAG_IO, (" Restarting read pump"));
-        Status = ReadH4Packet(&FdoExtension->ReadContext,
-                              FdoExtension->ReadRequest,
-                              FdoExtension->ReadMemory,
-                              FdoExtension->ReadBuffer,
-                              INITIAL_H4_READ_SIZE);
+        Status = ReadPumpStart(FdoExtension);
         if (!NT_SUCCESS(Status)) {
-            DoTrace(LEVEL_ERROR, TFLAG_IO, ("ReadH4Packet [0] failed %!STATUS!", Status));
+            DoTrace(LEVEL_ERROR, TFLAG_IO, ("ReadPumpStart [0] failed %!STATUS!", Status));
             goto Done;
         }
     }
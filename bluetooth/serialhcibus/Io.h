@@ -48,6 +48,23 @@ Revision History:
 #define INITIAL_H4_READ_SIZE        (1+HCI_EVENT_HEADER_SIZE)
 #define MAX_H4_HCI_PACKET_SIZE      (1+HCI_ACL_HEADER_SIZE + HCI_MAX_ACL_PAYLOAD_SIZE)  // include packet type
 
+//
+// The read pump keeps READ_PUMP_BUFFER_COUNT reads of READ_PUMP_BUFFER_SIZE posted to
+// the UART.  A read returns as soon as any data has arrived, so on a busy link one read
+// carries many HCI packets; a read that sees no data for READ_PUMP_TIMEOUT_IN_MS
+// completes empty and is posted again.
+//
+#define READ_PUMP_BUFFER_SIZE       (4096)
+#define READ_PUMP_BUFFER_COUNT      (2)
+#define READ_PUMP_TIMEOUT_IN_MS     (1000)
+
+C_ASSERT(READ_PUMP_BUFFER_SIZE >= MAX_H4_HCI_PACKET_SIZE);
+
+//
+// Number of HCI packets delivered to the upper layer per acquisition of the queue lock
+//
+#define READ_BATCH_MAX_PACKETS      (32)
+
 #define BUFFER_AND_SIZE_ADJUSTED(Buffer, Size, SegmentCount, Increment) {Buffer += Increment; Size -= Increment; SegmentCount += Increment;}
 
 #include <PSHPACK1.H>
@@ -188,34 +205,95 @@ typedef struct _HCI_PACKET_ENTRY {
 } HCI_PACKET_ENTRY, *PHCI_PACKET_ENTRY;
 
 //
-// Use to track request completion path
+// State of a read pump buffer
 //
-typedef enum _READ_REQUEST_STATE {   
-    REQUEST_SENT     = 1,   // Request is being sent
-    REQUEST_PENDING  = 2,   // Request is pending first - asynchronous completion
-    REQUEST_COMPLETE = 3    // Request has completedly first - synchronous completion
-} READ_REQUEST_STATE;
-
+typedef enum _READ_BUFFER_STATE {
+    READ_BUFFER_FREE    = 0,   // Not posted
+    READ_BUFFER_PENDING = 1,   // Posted to the UART
+    READ_BUFFER_DONE    = 2    // Completed; waiting to be processed
+} READ_BUFFER_STATE;
 
 //
-// Context used for reading UART operation to form HCI data or event packet
+// A buffer of the read pump and the request that reads into it
 //
-typedef struct _UART_READ_CONTEXT {
+typedef struct _UART_READ_BUFFER {
 
     //
-    // Status of this request
+    // Back pointer to the device extension
+    //
+    PFDO_EXTENSION FdoExtension;
+
+    //
+    // Preallocated WDF request and memory object, reused for every read
+    //
+    WDFREQUEST  Request;
+    WDFMEMORY   Memory;
+
+    //
+    // READ_BUFFER_STATE; changed with Interlocked operations
+    //
+    LONG State;
+
+    //
+    // Result of the last read
     //
     NTSTATUS Status;
-    
+    ULONG BytesRead;
+
+    UCHAR Buffer[READ_PUMP_BUFFER_SIZE];
+
+} UART_READ_BUFFER, *PUART_READ_BUFFER;
+
+//
+// HCI packets parsed from the read data and waiting to be delivered.  Packets point
+// into a read buffer or the read context, so a batch is flushed before either is reused.
+//
+typedef struct _HCI_BATCH_ENTRY {
+    UCHAR       Type;
+    ULONG       PacketLen;
+    PUCHAR      Packet;
+    WDFREQUEST  Request;    // Request matched to this packet while flushing
+} HCI_BATCH_ENTRY, *PHCI_BATCH_ENTRY;
+
+typedef struct _HCI_PACKET_BATCH {
+    ULONG           Count;
+    HCI_BATCH_ENTRY Entries[READ_BATCH_MAX_PACKETS];
+} HCI_PACKET_BATCH, *PHCI_PACKET_BATCH;
+
+
+//
+// Context used for reading UART operation to form HCI data or event packet
+//
+typedef struct _UART_READ_CONTEXT {
+
     //
     // Back pointer to the device extension
     //
     PFDO_EXTENSION FdoExtension;
 
     //
-    // State machine for the read Request 
+    // Read buffers kept posted to the UART and the next one to process; reads
+    // complete, and are processed, in the order they were posted.
+    //
+    UART_READ_BUFFER ReadBuffers[READ_PUMP_BUFFER_COUNT];
+    ULONG BufferCount;
+    ULONG NextBuffer;
+
+    //
+    // TRUE if the UART read timeouts let a read return with whatever has arrived;
+    // otherwise one read at a time is posted, sized to what the parser needs next.
+    //
+    BOOLEAN BulkReads;
+
+    //
+    // Completed reads are processed only by the caller that raises this from 0
+    //
+    volatile LONG ServiceCount;
+
+    //
+    // Packets parsed but not yet delivered
     //
-    READ_REQUEST_STATE  RequestState;
+    HCI_PACKET_BATCH Batch;
 
     //
     // State machine of repeat read (read pump) to complete an HCI packet
@@ -223,14 +223,6 @@ typedef struct _FDO_EXTENSION
     //
     UART_READ_CONTEXT ReadContext;
 
-    //
-    // Preallocated local WDF requested and memory object that is reused to
-    // implement read pump
-    //
-    WDFREQUEST  ReadRequest;
-    WDFMEMORY   ReadMemory;
-    UCHAR       ReadBuffer[MAX_H4_HCI_PACKET_SIZE];
-
 #if DBG
     //
     // Track last completed HCI packet
@@ -470,14 +462,19 @@ ReadRequestComplete(_In_ PFDO_EXTENSION    _FdoExtension,
                     _Inout_  PLIST_ENTRY   _ListHead,
                     _Inout_  PLONG         _ListCount);
 
+VOID
+ReadPacketBatchAdd(_In_ PFDO_EXTENSION _FdoExtension,
+                   _In_ UCHAR          _PacketType,
+                   _In_reads_bytes_(_PacketLength) PUCHAR _Packet,
+                   _In_ ULONG          _PacketLength);
+
+VOID
+ReadPacketBatchFlush(_In_ PFDO_EXTENSION _FdoExtension);
+
 EVT_WDF_REQUEST_COMPLETION_ROUTINE ReadH4PacketCompletionRoutine;
 
 NTSTATUS
-ReadH4Packet(_In_ PUART_READ_CONTEXT _ReadContext,
-             _In_  WDFREQUEST        _WdfRequest,
-             _In_  WDFMEMORY         _WdfMemory,
-             _Pre_notnull_ _Pre_writable_byte_size_(_BufferLen) PVOID _Buffer,
-             _In_  ULONG             _BufferLen);
+ReadPumpStart(_In_ PFDO_EXTENSION _FdoExtension);
 
 //
 // Device.c
@@ -499,44 +499,93 @@ ReadH4PacketComplete(
     _In_reads_bytes_(_BufferLength) PUCHAR _Buffer,
     ULONG  _BufferLength
     )
+/*++
+
+Routine Description:
+
+    Deliver a packet that was reassembled in the read context.  The reassembly
+    buffer is reused for the next packet, so the batch is flushed right away;
+    this happens at most once per read, for the packet that straddled the
+    previous read.
+
+Arguments:
+
+    _FdoExtension - Device context
+    _Type - HCI packet type (Event or AclData)
+    _Buffer - HCI packet, not including the packet type
+    _BufferLength - length of the HCI packet
+
+Return Value:
+
+    NTSTATUS
+
+--*/
 {
     NTSTATUS Status = STATUS_SUCCESS;
 
     DoTrace(LEVEL_INFO, TFLAG_IO, ("+ReadH4PacketComplete %S Packet Length %d",
         _Type == (UCHAR) HciPacketEvent ? L"Event" : L"AclData", _BufferLength ));
 
-#if DBG
-    // Tracking last completed packet
-    RtlCopyMemory(_FdoExtension->LastPacket, _Buffer, _BufferLength);
-    _FdoExtension->LastPacketLength = _BufferLength;
-#endif
+    ReadPacketBatchAdd(_FdoExtension, _Type, _Buffer, _BufferLength);
+    ReadPacketBatchFlush(_FdoExtension);
 
-    if (_Type == (UCHAR) HciPacketEvent)
-    {
-        ReadRequestComplete(_FdoExtension,
-                            HciPacketEvent,
-                            _BufferLength,
-                            _Buffer,
-                            _FdoExtension->ReadEventQueue,
-                            &_FdoExtension->EventQueueCount,
-                            &_FdoExtension->ReadEventList,
-                            &_FdoExtension->EventListCount);
+    DoTrace(LEVEL_INFO, TFLAG_IO, ("-ReadH4PacketComplete %!STATUS!", Status));
+
+    return Status;
+}
+
+ULONG
+ReadH4PacketFullLength(
+    _In_reads_bytes_(_BufferLength) PUCHAR _Buffer,
+    _In_ ULONG _BufferLength
+    )
+/*++
+
+Routine Description:
+
+    Check whether a whole H4 packet starts at the beginning of the buffer.
+
+Arguments:
+
+    _Buffer - read data, starting at a packet type
+    _BufferLength - bytes of data in the buffer
+
+Return Value:
+
+    Length of the H4 packet, including its packet type, if all of it is in the
+    buffer; 0 if it is not, or if the packet is malformed and must be left to
+    the state machine to report.
+
+--*/
+{
+    ULONG PacketLen;
+    ULONG DataLength;
+
+    if (_BufferLength < 1 + HCI_EVENT_HEADER_SIZE) {
+        return 0;
     }
-    else
-    {
-        ReadRequestComplete(_FdoExtension,
-                            HciPacketAclData,
-                            _BufferLength,
-                            _Buffer,
-                            _FdoExtension->ReadDataQueue,
-                           &_FdoExtension->DataQueueCount,
-                           &_FdoExtension->ReadDataList,
-                           &_FdoExtension->DataListCount);
+
+    if (_Buffer[0] == (UCHAR) HciPacketEvent) {
+        PacketLen = 1 + HCI_EVENT_HEADER_SIZE + _Buffer[2];
     }
+    else if (_Buffer[0] == (UCHAR) HciPacketAclData) {
+        if (_BufferLength < 1 + HCI_ACL_HEADER_SIZE) {
+            return 0;
+        }
 
-    DoTrace(LEVEL_INFO, TFLAG_IO, ("-ReadH4PacketComplete %!STATUS!", Status));
+        // DataLength is little endian and follows the 2-byte handle and flags
+        DataLength = _Buffer[3] | (_Buffer[4] << 8);
+        if (DataLength > HCI_MAX_ACL_PAYLOAD_SIZE) {
+            return 0;
+        }
 
-    return Status;
+        PacketLen = 1 + HCI_ACL_HEADER_SIZE + DataLength;
+    }
+    else {
+        return 0;
+    }
+
+    return PacketLen <= _BufferLength ? PacketLen : 0;
 }
 
 NTSTATUS
@@ -576,26 +625,16 @@ Return Value:
         _BytesRead, _ReadContext->ReadSegmentState));
 
     //
-    // By design, it will take two reads to complete an H4 packets.
-    //
-    // First Read (5 bytes = 1 + 4 = Type + Larger of (ACLDataHeader:4, EvetnHeader:2))
-    //
-    //   - Event
-    //       Complete (1 + 2    ), this is an Event packet without any param.
-    //       Complete (1 + 2 + 1), event with 1 param
-    //         * These two outcome requires interval timeout to complete the read (ask for 5).
-    //       Complete (1 + 2 + 2), event with 2 params
-    //         * if completed with one read, do the First read again.
+    // A read can hold any number of H4 packets, and its first and last packet
+    // may be split with the reads before and after it.
     //
-    //       Partial  (1 + 2 + 2 + ParamCount-2), this will complete in next read
-    //            BytesToRead = ParamCount - 2
+    //   - A packet that is entirely in this read is delivered straight from the
+    //     read buffer (GET_PKT_TYPE fast path below).
+    //   - A packet that is split is copied into the read context segment by
+    //     segment (Type, Header, Payload) until it is complete.
     //
-    //   - ACL Data
-    //       Partial (1 + 4 + DataLength), this packet will be complete in next read
-    //            ByteToRead = DataLength
-    // Second read
-    //   - Event/AclData
-    //       Complete (5 + BytesToRead)
+    // Delivered packets are batched and handed to the upper layer when the
+    // batch fills up or when this read has been consumed.
     //
 
     while (NT_SUCCESS(Status) && BytesRemained > 0) {
@@ -603,6 +642,17 @@ Return Value:
         // Process read buffer based on its read state
         switch (_ReadContext->ReadSegmentState) {
         case GET_PKT_TYPE:
+            PacketLen = ReadH4PacketFullLength(Buffer, BytesRemained);
+            if (PacketLen) {
+                DoTrace(LEVEL_INFO, TFLAG_DATA, (" [%S completed in place] PacketLen %d",
+                        *Buffer == (UCHAR) HciPacketEvent ? L"Event" : L"AclData",
+                        PacketLen - 1));
+                ReadPacketBatchAdd(FdoExtension, *Buffer, Buffer + 1, PacketLen - 1);
+                Buffer += PacketLen;
+                BytesRemained -= PacketLen;
+                break;
+            }
+
             H4Packet = (PH4_PACKET) Buffer;
             BUFFER_AND_SIZE_ADJUSTED(Buffer, BytesRemained, _ReadContext->BytesReadNextSegment, 1);
 
@@ -805,84 +855,62 @@ Return Value:
         }
     }
 
+    // Packets delivered in place point into the read buffer, which is about to be reused.
+    ReadPacketBatchFlush(FdoExtension);
+
     return Status;
 
 OutOfSync:
 
     DoTrace(LEVEL_ERROR, TFLAG_IO, (" Out-of-sync error detected in ProcessReadBuffer() %!STATUS!", Status));
 
+    // Still deliver the packets that preceded the error.
+    ReadPacketBatchFlush(FdoExtension);
+
     return Status;
 }
 
-VOID
-ReadH4PacketCompletionRoutine(
-    _In_  WDFREQUEST   _Request,
-    _In_  WDFIOTARGET  _Target,
-    _In_  PWDF_REQUEST_COMPLETION_PARAMS  _Params,
-    _In_  WDFCONTEXT  _Context
+NTSTATUS
+ReadPumpProcess(
+    _In_  PUART_READ_CONTEXT _ReadContext,
+    _In_  PUART_READ_BUFFER  _ReadBuffer
     )
 /*++
 
 Routine Description:
 
-    This is CR function for reading data from device.  It process the data read and
-    send down another request unless there is an error or the request is being
-    canceled.
+    Process a completed read of the read pump: parse the data it holds into HCI
+    packets and deliver them.
 
 Arguments:
 
-    _Request - a caller allocated WDF Request
-    _Target - WDF IO Target
-    _Params - Completion parameters
-    _Context - Context of this request
+    _ReadContext - Context used for reading data from target UART device
+    _ReadBuffer - the completed read
 
 Return Value:
 
-    none
+    NTSTATUS - STATUS_SUCCESS to keep the pump running; an error stops it.
 
 --*/
 {
-    NTSTATUS Status;
-    PUART_READ_CONTEXT ReadContext;
-    PFDO_EXTENSION FdoExtension;
-    ULONG BytesRead;
-    WDFMEMORY ReadMemory;
-    PUCHAR  OutBuffer;
-    size_t  OutBufferSize;
-    READ_REQUEST_STATE PreviousState;
-
-    UNREFERENCED_PARAMETER(_Request);
-    UNREFERENCED_PARAMETER(_Target);
-
-    // Operation result
-    Status = _Params->IoStatus.Status;
-    BytesRead =  (ULONG) _Params->Parameters.Read.Length;
-
-    ReadContext = (PUART_READ_CONTEXT) _Context;
-    ReadContext->Status = Status;
-
-    // Set to REQUEST_COMPLETE if skip REQUEST_PENDING state.
-    PreviousState = InterlockedCompareExchange((PLONG)&ReadContext->RequestState,
-                                               REQUEST_COMPLETE,
-                                               REQUEST_SENT);
-
-    DoTrace(LEVEL_WARNING, TFLAG_DATA, ("+ReadH4PacketCompletionRoutine %!STATUS! %d BytesRead %S)",
-            Status, BytesRead, PreviousState == REQUEST_PENDING ? L"Async" : L"*Sync*"));
-
-    FdoExtension = (PFDO_EXTENSION) ReadContext->FdoExtension;
+    NTSTATUS Status = _ReadBuffer->Status;
+    PFDO_EXTENSION FdoExtension = _ReadContext->FdoExtension;
+    ULONG BytesRead = _ReadBuffer->BytesRead;
+    PUCHAR OutBuffer = _ReadBuffer->Buffer;
 
     //
     // The return status can either be
-    //      - successful (buffer completely filled),
-    //      - timeout (buffer not completed filled prior to interval timeout expired
+    //      - successful (data arrived, or the buffer completely filled),
+    //      - timeout (no data arrived before the read timed out)
     //      - cancellation
     //      - failure
     //
     if (NT_SUCCESS(Status) || Status == STATUS_IO_TIMEOUT || Status == STATUS_TIMEOUT) {
         // Continue to process
+        Status = STATUS_SUCCESS;
     }
     else  {
-        DoTrace(LEVEL_ERROR, TFLAG_IO, (" ReadH4PacketCompletionRoutine failed %!STATUS!", Status));
+        DoTrace(LEVEL_ERROR, TFLAG_IO, (" ReadPumpProcess failed %!STATUS!", Status));
         if (Status == STATUS_CANCELLED) {
             //
             // Under regualr operational state, IO Target will only cancel a request
@@ -893,24 +921,21 @@ Return Value:
         goto Exit;
     }
 
-    ReadMemory = _Params->Parameters.Read.Buffer;
-    OutBuffer = (PUCHAR) WdfMemoryGetBuffer(ReadMemory, &OutBufferSize);
-    NT_ASSERT(OutBufferSize >= BytesRead);
-    DoTrace(LEVEL_INFO, TFLAG_IO, (" ReadH4PacketCompletionRoutine %d BytesRead pBuffer %p", BytesRead, OutBuffer));
+    DoTrace(LEVEL_INFO, TFLAG_IO, (" ReadPumpProcess %d BytesRead pBuffer %p", BytesRead, OutBuffer));
 
     //
     // Process a read buffer if there is data
     //
-    if (OutBuffer && BytesRead)
+    if (BytesRead)
     {
         //
-        // Process the incoming data to form partial or full H4 packet
+        // Process the incoming data to form partial or full H4 packets
         //
-        Status = ReadH4PacketReassemble(ReadContext,
+        Status = ReadH4PacketReassemble(_ReadContext,
                                         BytesRead,
                                         OutBuffer);
 
-        // If data stream error, ignore the packet and start over.
+        // If data stream error, ignore the rest of this read and start over.
         if (!NT_SUCCESS(Status))
         {
             FdoExtension->OutOfSyncErrorCount++;
@@ -920,7 +945,7 @@ Return Value:
             NT_ASSERT(NT_SUCCESS(Status) && L"Encountered an out-of-sync condition!");
 
             // Prepare to read next data packet, starting with packet type.
-            ReadSegmentStateSet(ReadContext, GET_PKT_TYPE);
+            ReadSegmentStateSet(_ReadContext, GET_PKT_TYPE);
 
             // Log(Error): log statistic of the read pump until this error
 
@@ -972,73 +997,144 @@ Return Value:
                 FdoExtension->HardwareErrorDetected = FALSE;
 
                 // try next
-                goto ReadNext;
+                Status = STATUS_SUCCESS;
             }
         }
     }
-    else
-    {
-        NT_ASSERT(Status == STATUS_TIMEOUT);
+
+Exit:
+
+    return Status;
+}
+
+NTSTATUS
+ReadPumpSend(
+    _In_  PUART_READ_CONTEXT _ReadContext,
+    _In_  PUART_READ_BUFFER  _ReadBuffer
+    )
+/*++
+
+Routine Description:
+
+    Post one of the read pump's buffers to the UART.  If it cannot be sent,
+    the buffer is marked completed with the error so that the pump stops when
+    it reaches it.
+
+Arguments:
+
+    _ReadContext - Context used for reading data from target UART device
+    _ReadBuffer - the buffer to post
+
+Return Value:
+
+    NTSTATUS
+
+--*/
+{
+    PFDO_EXTENSION   FdoExtension;
+    WDF_REQUEST_REUSE_PARAMS RequestReuseParams;
+    NTSTATUS Status;
+    ULONG BytesToRead;
+
+    FdoExtension = _ReadContext->FdoExtension;
+
+    //
+    // Determine what is the size of the buffer to send down.  Without bulk
+    // reads, a read completes only once it is full, so ask for no more than
+    // the parser needs next.
+    //
+    if (_ReadContext->BulkReads) {
+        BytesToRead = sizeof(_ReadBuffer->Buffer);
+    }
+    else {
+        BytesToRead = (_ReadContext->ReadSegmentState == GET_PKT_TYPE ? INITIAL_H4_READ_SIZE :
+                       _ReadContext->BytesToRead4FullPacket ? _ReadContext->BytesToRead4FullPacket :
+                       MAX_H4_HCI_PACKET_SIZE);
     }
 
-ReadNext:
+    DoTrace(LEVEL_INFO, TFLAG_IO, ("+ReadPumpSend(Read Buffer Size %d bytes)", BytesToRead));
 
-    if (PreviousState == REQUEST_PENDING)
-    {
-        ULONG BytesToRead;
+    if (!IsDeviceInitialized(FdoExtension)) {
+        Status = STATUS_DEVICE_NOT_READY;
+        DoTrace(LEVEL_ERROR, TFLAG_IO, (" ReadPumpSend: cannot attach IO %!STATUS!", Status));
+        goto Done;
+    }
 
-        //
-        // Determine what is the size of the buffer to send down.
-        //
-        BytesToRead = (ReadContext->ReadSegmentState == GET_PKT_TYPE ? INITIAL_H4_READ_SIZE :
-                       ReadContext->BytesToRead4FullPacket ? ReadContext->BytesToRead4FullPacket :
-                       sizeof(FdoExtension->ReadBuffer));
-
-        DoTrace(LEVEL_INFO, TFLAG_IO, (" ReadH4Packet(Read Buffer Size %d bytes)", BytesToRead));
-
-        // Issue next read here since this request was complete asychronously
-        // i.e. pending first and then this completion routein is invoked.
-        ReadH4Packet(ReadContext,
-                     FdoExtension->ReadRequest,
-                     FdoExtension->ReadMemory,
-                     FdoExtension->ReadBuffer,
-                     BytesToRead);
+    //
+    // Issue a read request
+    //
+    WDF_REQUEST_REUSE_PARAMS_INIT(&RequestReuseParams, WDF_REQUEST_REUSE_NO_FLAGS, STATUS_SUCCESS);
+    Status = WdfRequestReuse(_ReadBuffer->Request, &RequestReuseParams);
+    if (!NT_SUCCESS(Status)) {
+        DoTrace(LEVEL_ERROR, TFLAG_IO, (" WdfRequestReuse failed %!STATUS!", Status));
+        goto Done;
     }
-    else
-    {
-        // Fall through and leave this fucntion if this request was completed synchronously;
-        // i.e. this function is invoked first and then return to the RequestSent function.
+
+    Status = WdfMemoryAssignBuffer(_ReadBuffer->Memory, _ReadBuffer->Buffer, BytesToRead);
+    if (!NT_SUCCESS(Status)) {
+        DoTrace(LEVEL_ERROR, TFLAG_IO, (" WdfMemoryAssignBuffer failed %!STATUS!", Status));
+        goto Done;
+    }
+
+    Status = WdfIoTargetFormatRequestForRead(FdoExtension->IoTargetSerial,
+                                             _ReadBuffer->Request,
+                                             _ReadBuffer->Memory,
+                                             NULL, NULL);
+
+    if (!NT_SUCCESS(Status)) {
+        DoTrace(LEVEL_ERROR, TFLAG_IO, (" WdfIoTargetFormatRequestForRead failed %!STATUS!", Status));
+        goto Done;
     }
 
-    DoTrace(LEVEL_INFO, TFLAG_IO, ("-CR_ReadReadIO (fall though)"));
+    // Note: This request is sent to UART driver so it cannot be marked cancellable.
+    // But it can be canceled by issuing WdfRequestCancelSentRequest().
 
-    return;
+    WdfRequestSetCompletionRoutine(_ReadBuffer->Request,
+                                   ReadH4PacketCompletionRoutine,
+                                   _ReadBuffer);
 
-Exit:
+    // The request can complete before WdfRequestSend returns.
+    InterlockedExchange(&_ReadBuffer->State, READ_BUFFER_PENDING);
+
+    if (FALSE == WdfRequestSend(_ReadBuffer->Request,
+                                FdoExtension->IoTargetSerial,
+                                WDF_NO_SEND_OPTIONS))
+    {
+        Status = WdfRequestGetStatus(_ReadBuffer->Request);
+        DoTrace(LEVEL_ERROR, TFLAG_IO, (" WdfRequestSend failed %!STATUS!", Status));
+
+        // Not much we can do if cannot send this request; data pump will be stopped!
+        goto Done;
+    }
+
+    Status = STATUS_PENDING;
+
+Done:
 
     if (!NT_SUCCESS(Status))
     {
-        NT_ASSERT(Status == STATUS_CANCELLED);
-        FdoExtension->ReadPumpRunning = FALSE;
-        DoTrace(LEVEL_WARNING, TFLAG_IO, (" Pump has stopped!"));
+        _ReadBuffer->Status = Status;
+        _ReadBuffer->BytesRead = 0;
+        InterlockedExchange(&_ReadBuffer->State, READ_BUFFER_DONE);
     }
 
-    DoTrace(LEVEL_INFO, TFLAG_IO, ("-CR_ReadReadIO (error)"));
+    DoTrace(LEVEL_INFO, TFLAG_IO, ("-ReadPumpSend %!STATUS!", Status));
+
+    return Status;
 }
 
-NTSTATUS
-ReadH4Packet(
-    _In_  PUART_READ_CONTEXT _ReadContext,
-    _In_  WDFREQUEST         _WdfRequest,
-    _In_  WDFMEMORY          _WdfMemory,
-    _Pre_notnull_ _Pre_writable_byte_size_ (_BufferLen) PVOID _Buffer,
-    _In_  ULONG              _BufferLen
+VOID
+ReadPumpDrain(
+    _In_  PUART_READ_CONTEXT _ReadContext
     )
 /*++
 
 Routine Description:
 
-    Initiate the reading of an HCI packet (event or data) by sending down a read request.
+    Process the completed reads in the order they were posted, and post each
+    buffer again once it has been processed.  The caller must have raised
+    ServiceCount from 0; completions that arrive meanwhile only raise it
+    further and are picked up here.
 
 Arguments:
 
@@ -1046,125 +1142,197 @@ Arguments:
 
 Return Value:
 
-    NTSTATUS
+    none
 
 --*/
 {
-    PFDO_EXTENSION   FdoExtension;
-    WDF_REQUEST_REUSE_PARAMS RequestReuseParams;
+    PFDO_EXTENSION FdoExtension = _ReadContext->FdoExtension;
+    PUART_READ_BUFFER ReadBuffer;
     NTSTATUS Status;
 
-    DoTrace(LEVEL_INFO, TFLAG_IO, ("+ReadH4Packet"));
+    do {
+        while (TRUE) {
+            ReadBuffer = &_ReadContext->ReadBuffers[_ReadContext->NextBuffer];
 
-    FdoExtension = _ReadContext->FdoExtension;
+            // Reads complete in order; stop at the first one still pending.
+            if (READ_BUFFER_DONE != InterlockedCompareExchange(&ReadBuffer->State,
+                                                               READ_BUFFER_FREE,
+                                                               READ_BUFFER_DONE)) {
+                break;
+            }
 
-    if (0 == _BufferLen) {
-        DoTrace(LEVEL_ERROR, TFLAG_IO, (" ReadH4Packet: _BufferLen cannot be 0"));
-        Status = STATUS_INVALID_PARAMETER;
-        goto Done;
+            _ReadContext->NextBuffer = (_ReadContext->NextBuffer + 1) % _ReadContext->BufferCount;
+
+            Status = ReadPumpProcess(_ReadContext, ReadBuffer);
+
+            if (NT_SUCCESS(Status) && FdoExtension->ReadPumpRunning) {
+                ReadPumpSend(_ReadContext, ReadBuffer);
+            }
+            else if (FdoExtension->ReadPumpRunning) {
+                NT_ASSERT(Status == STATUS_CANCELLED);
+                FdoExtension->ReadPumpRunning = FALSE;
+                DoTrace(LEVEL_WARNING, TFLAG_IO, (" Pump has stopped!"));
+            }
+        }
+    } while (InterlockedDecrement(&_ReadContext->ServiceCount) != 0);
+}
+
+VOID
+ReadH4PacketCompletionRoutine(
+    _In_  WDFREQUEST   _Request,
+    _In_  WDFIOTARGET  _Target,
+    _In_  PWDF_REQUEST_COMPLETION_PARAMS  _Params,
+    _In_  WDFCONTEXT  _Context
+    )
+/*++
+
+Routine Description:
+
+    This is CR function for reading data from device.  It records the result of
+    the read and, unless another thread is already doing so, processes the
+    completed reads and posts them again.
+
+Arguments:
+
+    _Request - a caller allocated WDF Request
+    _Target - WDF IO Target
+    _Params - Completion parameters
+    _Context - Read buffer of this request
+
+Return Value:
+
+    none
+
+--*/
+{
+    PUART_READ_BUFFER ReadBuffer = (PUART_READ_BUFFER) _Context;
+    PUART_READ_CONTEXT ReadContext = &ReadBuffer->FdoExtension->ReadContext;
+
+    UNREFERENCED_PARAMETER(_Request);
+    UNREFERENCED_PARAMETER(_Target);
+
+    // Operation result
+    ReadBuffer->Status = _Params->IoStatus.Status;
+    ReadBuffer->BytesRead =  (ULONG) _Params->Parameters.Read.Length;
+
+    DoTrace(LEVEL_WARNING, TFLAG_DATA, ("+ReadH4PacketCompletionRoutine %!STATUS! %d BytesRead",
+            ReadBuffer->Status, ReadBuffer->BytesRead));
+
+    InterlockedExchange(&ReadBuffer->State, READ_BUFFER_DONE);
+
+    //
+    // If this read completed synchronously in ReadPumpSend, or another read is
+    // being processed, the caller that is draining the pump will pick it up.
+    //
+    if (InterlockedIncrement(&ReadContext->ServiceCount) == 1) {
+        ReadPumpDrain(ReadContext);
     }
 
-    while (TRUE) {
+    DoTrace(LEVEL_INFO, TFLAG_IO, ("-ReadH4PacketCompletionRoutine"));
+}
 
-        DoTrace(LEVEL_INFO, TFLAG_IO, (" ReadH4Packet - <start>"));
-        NT_ASSERT(_ReadContext->RequestState != REQUEST_SENT);
+NTSTATUS
+ReadPumpStart(
+    _In_  PFDO_EXTENSION _FdoExtension
+    )
+/*++
 
-        if (!IsDeviceInitialized(FdoExtension)) {
-            Status = STATUS_DEVICE_NOT_READY;
-            DoTrace(LEVEL_ERROR, TFLAG_IO, (" ReadH4Packet: cannot attach IO %!STATUS!", Status));
-            goto Done;
-        }
+Routine Description:
 
-        //
-        // Issue a read event request
-        //
-        WDF_REQUEST_REUSE_PARAMS_INIT(&RequestReuseParams, WDF_REQUEST_REUSE_NO_FLAGS, STATUS_SUCCESS);
-        Status = WdfRequestReuse(_WdfRequest, &RequestReuseParams);
-        if (!NT_SUCCESS(Status)) {
-            DoTrace(LEVEL_ERROR, TFLAG_IO, (" WdfRequestReuse failed %!STATUS!", Status));
-            goto Done;
-        }
+    Start the read pump that prefetches HCI events and data from the device.
 
-        Status = WdfMemoryAssignBuffer(_WdfMemory, _Buffer, _BufferLen);
-        if (!NT_SUCCESS(Status)) {
-            DoTrace(LEVEL_ERROR, TFLAG_IO, (" WdfMemoryAssignBuffer failed %!STATUS!", Status));
-            goto Done;
-        }
+    The UART read timeouts are set so that a read returns as soon as any data
+    has arrived; both read buffers are then kept posted so that the UART always
+    has a read to complete while the previous one is being parsed.  If the
+    timeouts cannot be set, the pump falls back to a single read at a time,
+    each sized to what the parser needs next.
 
-        Status = WdfIoTargetFormatRequestForRead(FdoExtension->IoTargetSerial,
-                                                 _WdfRequest,
-                                                 _WdfMemory,
-                                                 NULL, NULL);
+Arguments:
 
-        if (!NT_SUCCESS(Status)) {
-            DoTrace(LEVEL_ERROR, TFLAG_IO, (" WdfIoTargetFormatRequestForRead failed %!STATUS!", Status));
-            goto Done;
-        }
+    _FdoExtension - Device context
 
-        // Note: This request is sent to UART driver so it cannot be marked cancellable.
-        // But it can be canceled by issuing WdfRequestCancelSentRequest().
+Return Value:
 
-        WdfRequestSetCompletionRoutine(_WdfRequest,
-                                       ReadH4PacketCompletionRoutine,
-                                       _ReadContext);
+    NTSTATUS
 
-        InterlockedExchange((PLONG)&_ReadContext->RequestState, REQUEST_SENT);
+--*/
+{
+    PUART_READ_CONTEXT ReadContext = &_FdoExtension->ReadContext;
+    SERIAL_TIMEOUTS Timeouts;
+    WDF_MEMORY_DESCRIPTOR MemoryDescriptor;
+    WDF_REQUEST_SEND_OPTIONS Options;
+    NTSTATUS Status;
+    ULONG Index;
 
-        if (FALSE == WdfRequestSend(_WdfRequest,
-                                    FdoExtension->IoTargetSerial,
-                                    WDF_NO_SEND_OPTIONS))
-        {
-            Status = WdfRequestGetStatus(_WdfRequest);
-            DoTrace(LEVEL_ERROR, TFLAG_IO, (" WdfRequestSend failed %!STATUS!", Status));
+    DoTrace(LEVEL_INFO, TFLAG_IO, ("+ReadPumpStart"));
 
-            // Not much we can do if cannot send this request; data pump will be stopped!
-            goto Done;
-        }
-        else
-        {
-            READ_REQUEST_STATE PreviousState;
+    WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(&MemoryDescriptor, &Timeouts, sizeof(Timeouts));
+    WDF_REQUEST_SEND_OPTIONS_INIT(&Options, WDF_REQUEST_SEND_OPTION_TIMEOUT);
+    WDF_REQUEST_SEND_OPTIONS_SET_TIMEOUT(&Options, WDF_REL_TIMEOUT_IN_SEC(MAX_WRITE_TIMEOUT_IN_SEC));
 
-            // Set to REQUEST_PENDING if it is in the REQUEST_SENT state.
-            PreviousState = InterlockedCompareExchange((PLONG) &_ReadContext->RequestState,
-                                                       REQUEST_PENDING,
-                                                       REQUEST_SENT);
+    Status = WdfIoTargetSendIoctlSynchronously(_FdoExtension->IoTargetSerial,
+                                               NULL,
+                                               IOCTL_SERIAL_GET_TIMEOUTS,
+                                               NULL,
+                                               &MemoryDescriptor,
+                                               &Options,
+                                               NULL);
 
-            DoTrace(LEVEL_WARNING, TFLAG_IO, (" WdfRequestSend ReqState: %d -> %d",
-                    PreviousState, _ReadContext->RequestState));
+    if (NT_SUCCESS(Status)) {
+        //
+        // Return immediately with whatever has arrived, or wait up to
+        // READ_PUMP_TIMEOUT_IN_MS for the first byte.
+        //
+        Timeouts.ReadIntervalTimeout = MAXULONG;
+        Timeouts.ReadTotalTimeoutMultiplier = MAXULONG;
+        Timeouts.ReadTotalTimeoutConstant = READ_PUMP_TIMEOUT_IN_MS;
+
+        Status = WdfIoTargetSendIoctlSynchronously(_FdoExtension->IoTargetSerial,
+                                                   NULL,
+                                                   IOCTL_SERIAL_SET_TIMEOUTS,
+                                                   &MemoryDescriptor,
+                                                   NULL,
+                                                   &Options,
+                                                   NULL);
+    }
 
-            if (PreviousState == REQUEST_SENT)
-            {
-                // Request is still pending, and will be completed asychronously in the
-                // completion routine where it can issue next read.
-                Status = STATUS_PENDING;
-                break;
-            }
-            else
-            {
-                Status = FdoExtension->ReadContext.Status;
-                if (NT_SUCCESS(Status))
-                {
-                    // Previous request has been complete synchronously in the
-                    // completion routine; do next read in this function.
-                }
-                else
-                {
-                    // No tolerance for error
-                    break;
-                }
-            }
+    if (!NT_SUCCESS(Status)) {
+        DoTrace(LEVEL_WARNING, TFLAG_IO, (" Read timeouts not supported %!STATUS!; reading one segment at a time", Status));
+    }
+
+    // Start over with a new packet and free buffers
+    ReadContext->BulkReads = NT_SUCCESS(Status);
+    ReadContext->BufferCount = ReadContext->BulkReads ? READ_PUMP_BUFFER_COUNT : 1;
+    ReadContext->NextBuffer = 0;
+    ReadContext->Batch.Count = 0;
+    ReadSegmentStateSet(ReadContext, GET_PKT_TYPE);
+
+    for (Index = 0; Index < READ_PUMP_BUFFER_COUNT; Index++) {
+        ReadContext->ReadBuffers[Index].State = READ_BUFFER_FREE;
+    }
+
+    _FdoExtension->ReadPumpRunning = TRUE;
+
+    //
+    // Hold off processing until all the buffers are posted, so that they are
+    // posted, and therefore processed, in order.
+    //
+    ReadContext->ServiceCount = 1;
+
+    for (Index = 0; Index < ReadContext->BufferCount; Index++) {
+        Status = ReadPumpSend(ReadContext, &ReadContext->ReadBuffers[Index]);
+        if (!NT_SUCCESS(Status)) {
+            break;
         }
     }
 
-Done:
+    ReadPumpDrain(ReadContext);
 
-    if (!NT_SUCCESS(Status))
-    {
-        NT_ASSERT(Status == STATUS_CANCELLED);
-        FdoExtension->ReadPumpRunning = FALSE;
+    if (NT_SUCCESS(Status)) {
+        Status = STATUS_SUCCESS;
     }
 
-    DoTrace(LEVEL_INFO, TFLAG_IO, ("-ReadH4Packet %!STATUS!", Status));
+    DoTrace(LEVEL_INFO, TFLAG_IO, ("-ReadPumpStart %!STATUS!", Status));
 
     return Status;
 }
@@ -1188,6 +1356,93 @@ HLP_CreatePacketEntry(
     return PacketEntry;
 }
 
+NTSTATUS
+ReadRequestCompleteWithPacket(
+    _In_ PFDO_EXTENSION _FdoExtension,
+    _In_ WDFREQUEST     _Request,
+    _In_ UCHAR          _PacketType,
+    _In_ ULONG          _PacketLength,
+    _In_reads_bytes_(_PacketLength) PUCHAR _Packet
+    )
+/*++
+Routine Description:
+
+    This helper function copies an HCI packet to a read Request from the upper
+    layer and completes the Request.
+
+Arguments:
+
+    _FdoExtension - Device context
+    _Request - Request to complete
+    _PacketType - HCI packet type (either Event or Data for incoming data)
+    _PacketLength - length of the HCI packet
+    _Packet - HCI packet
+
+Return Value:
+
+    NTSTATUS - Status the Request was completed with
+
+--*/
+{
+    NTSTATUS    Status;
+    WDFMEMORY ReqOutMemory;
+    size_t BufferSize = 0, BytesToReturn;
+    PBTHX_HCI_READ_WRITE_CONTEXT HCIContext;
+
+    // Complete this request
+    Status = WdfRequestRetrieveOutputMemory(_Request, &ReqOutMemory);
+    if (Status != STATUS_SUCCESS) {
+        DoTrace(LEVEL_ERROR, TFLAG_IO, (" Could not retrieve output buffer"));
+        WdfRequestCompleteWithInformation(_Request, Status, (ULONG_PTR)0);
+        goto Done;
+    }
+
+    HCIContext = WdfMemoryGetBuffer(ReqOutMemory, &BufferSize);
+    BytesToReturn = FIELD_OFFSET(BTHX_HCI_READ_WRITE_CONTEXT, Data) + _PacketLength;
+
+    // This should not happen because BthMini should have sent down largest buffer according to device's capability.
+    NT_ASSERT(BytesToReturn <= BufferSize);
+
+    // Transfer data to Request's output buffer
+    HCIContext->Type    = _PacketType;
+    HCIContext->DataLen = _PacketLength;
+    if (BytesToReturn <= BufferSize) {
+        RtlCopyMemory(&HCIContext->Data, _Packet, _PacketLength);
+    }
+    else {
+        Status = STATUS_BUFFER_TOO_SMALL;
+        BytesToReturn = 0;
+    }
+
+    // Validate and print out (WPP) HCI packet info
+    HCIContextValidate(HCIContext->Type == (UCHAR) HciPacketEvent ?
+                       _FdoExtension->CntEventCompleted : _FdoExtension->CntReadDataCompleted,
+                       HCIContext);
+
+    if (HCIContext->Type == (UCHAR) HciPacketEvent) {
+        InterlockedIncrement(&_FdoExtension->CntEventCompleted);
+        DoTrace(LEVEL_INFO, TFLAG_DATA, (" [%d] HciPacketEvent completing %!STATUS!, %d BytesToReturn",
+                _FdoExtension->CntEventCompleted, Status, (ULONG) BytesToReturn));
+    }
+    else if (HCIContext->Type == (UCHAR) HciPacketAclData) {
+        InterlockedIncrement(&_FdoExtension->CntReadDataCompleted);
+        DoTrace(LEVEL_INFO, TFLAG_DATA, (" [%d] HciPacketAclData completing %!STATUS!, %d BytesToReturn",
+                _FdoExtension->CntReadDataCompleted, Status, (ULONG) BytesToReturn));
+    }
+
+    DoTrace(LEVEL_INFO, TFLAG_IO, (" Completing Request(%p) %!STATUS!, %d BytesToReturn",
+            _Request, Status, (ULONG) BytesToReturn));
+
+    //
+    // return only the actual data read, not including BTHX_HCI_READ_WRITE_CONTEXT
+    //
+    WdfRequestCompleteWithInformation(_Request, Status, BytesToReturn);
+
+Done:
+
+    return Status;
+}
+
 NTSTATUS
 ReadRequestComplete(
     _In_ PFDO_EXTENSION _FdoExtension,
@@ -1221,9 +1476,6 @@ Return Value:
     WDFREQUEST  Request = NULL;
     NTSTATUS    Status = STATUS_SUCCESS;
     PHCI_PACKET_ENTRY  PacketEntry = NULL;
-    WDFMEMORY ReqOutMemory;
-    size_t BufferSize = 0, BytesToReturn;
-    PBTHX_HCI_READ_WRITE_CONTEXT HCIContext;
     BOOLEAN CompleteRequest = FALSE;
 
     DoTrace(LEVEL_INFO, TFLAG_IO, ("+ReadRequestComplete"));
@@ -1302,35 +1554,7 @@ Return Value:
         goto Done;
     }
 
-    // Complete this request
-    Status = WdfRequestRetrieveOutputMemory(Request, &ReqOutMemory);
-    if (Status != STATUS_SUCCESS) {
-        DoTrace(LEVEL_ERROR, TFLAG_IO, (" Could not retrieve output buffer"));
-        WdfRequestCompleteWithInformation(Request, Status, (ULONG_PTR)0);
-        goto Done;
-    }
-
-    HCIContext = WdfMemoryGetBuffer(ReqOutMemory, &BufferSize);
-    BytesToReturn = FIELD_OFFSET(BTHX_HCI_READ_WRITE_CONTEXT, Data) + _PacketLength;
-
-    // This should not happen because BthMini should have sent down largest buffer according to device's capability.
-    NT_ASSERT(BytesToReturn <= BufferSize);
-
-    // Transfer data to Request's output buffer
-    HCIContext->Type    = _PacketType;
-    HCIContext->DataLen = _PacketLength;
-    if (BytesToReturn <= BufferSize) {
-        RtlCopyMemory(&HCIContext->Data, _Packet, _PacketLength);
-    }
-    else {
-        Status = STATUS_BUFFER_TOO_SMALL;
-        BytesToReturn = 0;
-    }
-
-    // Validate and print out (WPP) HCI packet info
-    HCIContextValidate(HCIContext->Type == (UCHAR) HciPacketEvent ?
-                       _FdoExtension->CntEventCompleted : _FdoExtension->CntReadDataCompleted,
-                       HCIContext);
+    Status = ReadRequestCompleteWithPacket(_FdoExtension, Request, _PacketType, _PacketLength, _Packet);
 
     //
     // Release memory allocated for a completed packet entry; it was not removed from the packet list.
@@ -1339,30 +1563,154 @@ Return Value:
         ExFreePool(PacketEntry);
     }
 
-    if (HCIContext->Type == (UCHAR) HciPacketEvent) {
-        InterlockedIncrement(&_FdoExtension->CntEventCompleted);
-        DoTrace(LEVEL_INFO, TFLAG_DATA, (" [%d] HciPacketEvent completing %!STATUS!, %d BytesToReturn",
-                _FdoExtension->CntEventCompleted, Status, (ULONG) BytesToReturn));
+Done:
+
+    DoTrace(LEVEL_INFO, TFLAG_IO, ("-ReadRequestComplete: %!STATUS!", Status));
+
+    return Status;
+}
+
+VOID
+ReadPacketBatchAdd(
+    _In_ PFDO_EXTENSION _FdoExtension,
+    _In_ UCHAR          _PacketType,
+    _In_reads_bytes_(_PacketLength) PUCHAR _Packet,
+    _In_ ULONG          _PacketLength
+    )
+/*++
+Routine Description:
+
+    Add a complete HCI packet to the batch that will be delivered to the upper
+    layer.  The packet is not copied, so it must stay valid until the batch is
+    flushed.
+
+Arguments:
+
+    _FdoExtension - Device context
+    _PacketType - HCI packet type (either Event or Data for incoming data)
+    _Packet - HCI packet, not including the packet type
+    _PacketLength - length of the HCI packet
+
+Return Value:
+
+    none
+
+--*/
+{
+    PHCI_PACKET_BATCH Batch = &_FdoExtension->ReadContext.Batch;
+    PHCI_BATCH_ENTRY  Entry;
+
+#if DBG
+    // Tracking last completed packet
+    RtlCopyMemory(_FdoExtension->LastPacket, _Packet, _PacketLength);
+    _FdoExtension->LastPacketLength = _PacketLength;
+#endif
+
+    if (Batch->Count == READ_BATCH_MAX_PACKETS) {
+        ReadPacketBatchFlush(_FdoExtension);
     }
-    else if (HCIContext->Type == (UCHAR) HciPacketAclData) {
-        InterlockedIncrement(&_FdoExtension->CntReadDataCompleted);
-        DoTrace(LEVEL_INFO, TFLAG_DATA, (" [%d] HciPacketAclData completing %!STATUS!, %d BytesToReturn",
-                _FdoExtension->CntReadDataCompleted, Status, (ULONG) BytesToReturn));
+
+    Entry = &Batch->Entries[Batch->Count++];
+    Entry->Type = _PacketType;
+    Entry->PacketLen = _PacketLength;
+    Entry->Packet = _Packet;
+    Entry->Request = NULL;
+}
+
+VOID
+ReadPacketBatchFlush(
+    _In_ PFDO_EXTENSION _FdoExtension
+    )
+/*++
+Routine Description:
+
+    Deliver the batched HCI packets.  Under a single acquisition of the queue
+    lock, each packet is matched to a pending Request from the upper layer or,
+    if there is none, appended to the prefetched packet list.  The matched
+    Requests are then completed outside the lock, in packet order.
+
+Arguments:
+
+    _FdoExtension - Device context
+
+Return Value:
+
+    none
+
+--*/
+{
+    PHCI_PACKET_BATCH Batch = &_FdoExtension->ReadContext.Batch;
+    PHCI_BATCH_ENTRY  Entry;
+    PHCI_PACKET_ENTRY PacketEntry;
+    WDFQUEUE    Queue;
+    PLONG       QueueCount;
+    PLIST_ENTRY ListHead;
+    PLONG       ListCount;
+    NTSTATUS    Status;
+    ULONG       Index;
+
+    if (Batch->Count == 0) {
+        return;
     }
 
-    DoTrace(LEVEL_INFO, TFLAG_IO, (" Completing Request(%p) %!STATUS!, %d BytesToReturn",
-            Request, Status, (ULONG) BytesToReturn));
+    DoTrace(LEVEL_INFO, TFLAG_IO, ("+ReadPacketBatchFlush %d packets", Batch->Count));
 
-    //
-    // return only the actual data read, not including BTHX_HCI_READ_WRITE_CONTEXT
-    //
-    WdfRequestCompleteWithInformation(Request, Status, BytesToReturn);
+    WdfSpinLockAcquire(_FdoExtension->QueueAccessLock);
 
-Done:
+    for (Index = 0; Index < Batch->Count; Index++) {
+        Entry = &Batch->Entries[Index];
 
-    DoTrace(LEVEL_INFO, TFLAG_IO, ("-ReadRequestComplete: %!STATUS!", Status));
+        if (Entry->Type == (UCHAR) HciPacketEvent) {
+            Queue = _FdoExtension->ReadEventQueue;
+            QueueCount = &_FdoExtension->EventQueueCount;
+            ListHead = &_FdoExtension->ReadEventList;
+            ListCount = &_FdoExtension->EventListCount;
+        }
+        else {
+            Queue = _FdoExtension->ReadDataQueue;
+            QueueCount = &_FdoExtension->DataQueueCount;
+            ListHead = &_FdoExtension->ReadDataList;
+            ListCount = &_FdoExtension->DataListCount;
+        }
 
-    return Status;
+        Status = WdfIoQueueRetrieveNextRequest(Queue, &Entry->Request);
+        if (Status == STATUS_SUCCESS) {
+            // Typical code path; see ReadRequestComplete
+            InterlockedDecrement(QueueCount);
+            NT_ASSERT(IsListEmpty(ListHead));
+        }
+        else {
+            Entry->Request = NULL;
+            PacketEntry = HLP_CreatePacketEntry(Entry->PacketLen, Entry->Packet);
+            if (PacketEntry == NULL) {
+                // This packet will be dropped; but nothing we can do as system resource is depleted!
+                DoTrace(LEVEL_ERROR, TFLAG_IO, (" Could not allocate HCI_PACKET_ENTRY"));
+            }
+            else {
+                // Cache this packet to Packet List
+                InsertTailList(ListHead, &PacketEntry->DataEntry);
+                InterlockedIncrement(ListCount);
+            }
+        }
+    }
+
+    WdfSpinLockRelease(_FdoExtension->QueueAccessLock);
+
+    for (Index = 0; Index < Batch->Count; Index++) {
+        Entry = &Batch->Entries[Index];
+
+        if (Entry->Request) {
+            ReadRequestCompleteWithPacket(_FdoExtension,
+                                          Entry->Request,
+                                          Entry->Type,
+                                          Entry->PacketLen,
+                                          Entry->Packet);
+        }
+    }
+
+    Batch->Count = 0;
+
+    DoTrace(LEVEL_INFO, TFLAG_IO, ("-ReadPacketBatchFlush"));
 }
 
 VOID
@@ -1386,6 +1734,7 @@ Return
 --*/
 {
     PFDO_EXTENSION     FdoExtension;
+    ULONG              Index;
 
     DoTrace(LEVEL_INFO, TFLAG_IO,("+ReadResourcesFree"));
 
@@ -1436,10 +1785,15 @@ Return
     }
     NT_ASSERT(FdoExtension->DataListCount == 0);
 
-    if (FdoExtension->ReadRequest)
+    for (Index = 0; Index < READ_PUMP_BUFFER_COUNT; Index++)
     {
-        WdfObjectDelete(FdoExtension->ReadRequest);
-        FdoExtension->ReadRequest = NULL;
+        PUART_READ_BUFFER ReadBuffer = &FdoExtension->ReadContext.ReadBuffers[Index];
+
+        if (ReadBuffer->Request)
+        {
+            WdfObjectDelete(ReadBuffer->Request);
+            ReadBuffer->Request = NULL;
+        }
     }
 }
 
@@ -1467,6 +1821,7 @@ Return Value:
     PFDO_EXTENSION   FdoExtension;
     WDF_IO_QUEUE_CONFIG QueueConfig;
     WDF_OBJECT_ATTRIBUTES ObjAttributes;
+    ULONG Index;
 
     DoTrace(LEVEL_INFO, TFLAG_IO,("+ReadResourcesAllocate"));
 
@@ -1526,34 +1881,42 @@ Return Value:
     FdoExtension->CntReadDataReq        = 0;
     FdoExtension->CntReadDataCompleted  = 0;
 
-    // Create a WDF Request
-    WDF_OBJECT_ATTRIBUTES_INIT(&ObjAttributes);
-    ObjAttributes.ParentObject = _Device;
-
-    Status = WdfRequestCreate(&ObjAttributes,
-                              FdoExtension->IoTargetSerial,
-                              &FdoExtension->ReadRequest);
-
-    if (!NT_SUCCESS(Status))
-    {
-        DoTrace(LEVEL_ERROR, TFLAG_IO, (" WdfRequestCreate(ReadRequest) failed %!STATUS!", Status));
-        goto Done;
-    }
-
     // Initialize the ReadContext and its initial ReadSegmentState
     RtlZeroMemory(&FdoExtension->ReadContext, sizeof(UART_READ_CONTEXT));
     FdoExtension->ReadContext.FdoExtension = FdoExtension;
     ReadSegmentStateSet(&FdoExtension->ReadContext, GET_PKT_TYPE);
 
-    Status = WdfMemoryCreatePreallocated(&ObjAttributes,
-                                         &FdoExtension->ReadBuffer,
-                                         sizeof(FdoExtension->ReadBuffer),
-                                         &FdoExtension->ReadMemory);
+    // Create a WDF Request and memory object for each read pump buffer
+    WDF_OBJECT_ATTRIBUTES_INIT(&ObjAttributes);
+    ObjAttributes.ParentObject = _Device;
 
-    if (!NT_SUCCESS(Status))
+    for (Index = 0; Index < READ_PUMP_BUFFER_COUNT; Index++)
     {
-        DoTrace(LEVEL_ERROR, TFLAG_IO, (" WdfMemoryCreatePreallocated(ReadMemory) failed %!STATUS!", Status));
-        goto Done;
+        PUART_READ_BUFFER ReadBuffer = &FdoExtension->ReadContext.ReadBuffers[Index];
+
+        ReadBuffer->FdoExtension = FdoExtension;
+        ReadBuffer->State = READ_BUFFER_FREE;
+
+        Status = WdfRequestCreate(&ObjAttributes,
+                                  FdoExtension->IoTargetSerial,
+                                  &ReadBuffer->Request);
+
+        if (!NT_SUCCESS(Status))
+        {
+            DoTrace(LEVEL_ERROR, TFLAG_IO, (" WdfRequestCreate(ReadRequest) failed %!STATUS!", Status));
+            goto Done;
+        }
+
+        Status = WdfMemoryCreatePreallocated(&ObjAttributes,
+                                             ReadBuffer->Buffer,
+                                             sizeof(ReadBuffer->Buffer),
+                                             &ReadBuffer->Memory);
+
+        if (!NT_SUCCESS(Status))
+        {
+            DoTrace(LEVEL_ERROR, TFLAG_IO, (" WdfMemoryCreatePreallocated(ReadMemory) failed %!STATUS!", Status));
+            goto Done;
+        }
     }
 
 Done:
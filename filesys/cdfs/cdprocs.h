@@ -82,9 +82,11 @@ Abstract:
 #define TAG_IRP_CONTEXT         'cidC'      //  Irp Context
 #define TAG_IRP_CONTEXT_LITE    'lidC'      //  Irp Context lite
 #define TAG_MCB_ARRAY           'amdC'      //  Mcb array
+#define TAG_NAME_TABLE          'tndC'      //  Directory name table
 #define TAG_PATH_ENTRY_NAME     'nPdC'      //  CdName in path entry
 #define TAG_PREFIX_ENTRY        'epdC'      //  Prefix Entry
 #define TAG_PREFIX_NAME         'npdC'      //  Prefix Entry name
+#define TAG_READ_AHEAD          'ardC'      //  Non-cached readahead context and buffer
 #define TAG_SPANNING_PATH_TABLE 'psdC'      //  Buffer for spanning path table
 #define TAG_UPCASE_NAME         'nudC'      //  Buffer for upcased name
 #define TAG_VOL_DESC            'dvdC'      //  Buffer for volume descriptor
@@ -276,6 +278,12 @@ CdNonCachedRead (
     _In_ ULONG ByteCount
     );
 
+VOID
+CdFreeReadAhead (
+    _In_ PIRP_CONTEXT IrpContext,
+    _Inout_ PFCB Fcb
+    );
+
 _Requires_lock_held_(_Global_critical_region_)
 NTSTATUS
 CdNonCachedXARead (
@@ -467,6 +475,12 @@ CdCleanupFileContext (
     _In_ PFILE_ENUM_CONTEXT FileContext
     );
 
+VOID
+CdFreeNameTable (
+    _In_ PIRP_CONTEXT IrpContext,
+    _Inout_ PFCB Fcb
+    );
+
 //
 //  VOID
 //  CdInitializeFileContext (
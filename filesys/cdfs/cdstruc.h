@@ -685,6 +685,8 @@ typedef struct _VCB {
 #if DBG
     ULONG SecCacheHits;
     ULONG SecCacheMisses;
+    ULONG ReadAheadHits;
+    ULONG ReadAheadFills;
 #endif
 } VCB, *PVCB;
 
@@ -766,6 +768,64 @@ typedef enum _FCB_CONDITION {
     FcbNeedsToBeVerified
 } FCB_CONDITION;
 
+//
+//  Readahead state for non-cached user reads of a data Fcb.  Once we see
+//  CD_READ_AHEAD_TRIGGER back to back sequential reads we read a window
+//  past the caller's range into a private buffer and satisfy the following
+//  reads from it.  The window doubles each time the previous buffer was
+//  used, up to CD_READ_AHEAD_MAX_WINDOW.  The media is read-only so the
+//  buffer never has to be invalidated for writes.  This structure is
+//  allocated from non-paged pool for the resource, the buffer is paged.
+//
+
+#define CD_READ_AHEAD_TRIGGER           (2)
+#define CD_READ_AHEAD_MIN_WINDOW        (0x10000)
+#define CD_READ_AHEAD_MAX_WINDOW        (0x40000)
+
+typedef struct _CD_READ_AHEAD {
+
+    //
+    //  Serializes use of this structure.  Readers only try to acquire this
+    //  and take the normal path if it is busy.  This is a resource rather
+    //  than a fast mutex since it is held across the fill Io.
+    //
+
+    ERESOURCE Resource;
+
+    //
+    //  Sequential detector.  File offset we expect the next read to start
+    //  at and the number of reads in a row which started there.
+    //
+
+    LONGLONG NextOffset;
+    ULONG SequentialCount;
+
+    //
+    //  Size of the next fill.
+    //
+
+    ULONG Window;
+
+    //
+    //  Buffered data, BufferLength bytes starting at file offset BufferOffset.
+    //  BufferUsed indicates a read was satisfied from the current fill.
+    //
+
+    PVOID Buffer;
+    LONGLONG BufferOffset;
+    ULONG BufferLength;
+    BOOLEAN BufferUsed;
+
+    //
+    //  Number of reads satisfied from the buffer and number of fills.
+    //
+
+    ULONG Hits;
+    ULONG Fills;
+
+} CD_READ_AHEAD;
+typedef CD_READ_AHEAD *PCD_READ_AHEAD;
+
 typedef struct _FCB_DATA {
 
 #if (NTDDI_VERSION < NTDDI_WIN8)
@@ -785,9 +845,57 @@ typedef struct _FCB_DATA {
 
     PFILE_LOCK FileLock;
 
+    //
+    //  Readahead state for non-cached reads, allocated on the first
+    //  sequential non-cached read of the file.
+    //
+
+    PCD_READ_AHEAD ReadAhead;
+
 } FCB_DATA;
 typedef FCB_DATA *PFCB_DATA;
 
+//
+//  A directory name table is built for an index Fcb the first time a file
+//  is looked up by name in a directory larger than CD_NAME_TABLE_MIN_DIR_SIZE.
+//  It records the stream offset and the upcased name hash of the initial
+//  dirent of every file in the directory so that later lookups only need to
+//  decode the dirents whose hash matches.  The on-disk directory can't change
+//  underneath us so the table lives until the Fcb is deleted.
+//
+
+#define CD_NAME_TABLE_MIN_DIR_SIZE      (4 * SECTOR_SIZE)
+#define CD_NAME_TABLE_NIL               (MAXULONG)
+
+typedef struct _CD_NAME_TABLE_ENTRY {
+
+    ULONG DirentOffset;
+    ULONG Hash;
+    ULONG Next;
+
+} CD_NAME_TABLE_ENTRY;
+typedef CD_NAME_TABLE_ENTRY *PCD_NAME_TABLE_ENTRY;
+
+typedef struct _CD_NAME_TABLE {
+
+    //
+    //  Hash buckets, a power of two in number.  Each bucket holds the index
+    //  of the first entry on its chain.  Chains are kept in directory order.
+    //
+
+    ULONG BucketMask;
+    PULONG Buckets;
+
+    //
+    //  Entries in directory order.
+    //
+
+    ULONG EntryCount;
+    PCD_NAME_TABLE_ENTRY Entries;
+
+} CD_NAME_TABLE;
+typedef CD_NAME_TABLE *PCD_NAME_TABLE;
+
 typedef struct _FCB_INDEX {
 
     //
@@ -835,6 +943,14 @@ typedef struct _FCB_INDEX {
     PRTL_SPLAY_LINKS ExactCaseRoot;
     PRTL_SPLAY_LINKS IgnoreCaseRoot;
 
+    //
+    //  Decoded name table for the files in this directory.  This is
+    //  NULL until the first lookup by name, and remains NULL if the
+    //  directory is small or we couldn't allocate the table.
+    //
+
+    PCD_NAME_TABLE NameTable;
+
 } FCB_INDEX;
 typedef FCB_INDEX *PFCB_INDEX;
 
@@ -1029,6 +1145,7 @@ typedef FCB *PFCB;
 #define FCB_STATE_MODE2FORM2_FILE               (0x00000004)
 #define FCB_STATE_MODE2_FILE                    (0x00000008)
 #define FCB_STATE_DA_FILE                       (0x00000010)
+#define FCB_STATE_NO_NAME_TABLE                 (0x00000020)
 
 //
 //  These file types are read as raw 2352 byte sectors
@@ -199,6 +199,16 @@ CdReadDirDataThroughCache (
     _In_ PIO_RUN Run
     );
 
+_Requires_lock_held_(_Global_critical_region_)
+BOOLEAN
+CdReadAheadNonCachedRead (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PFCB Fcb,
+    _In_ LONGLONG StartingOffset,
+    _In_ ULONG ByteCount,
+    _Out_writes_bytes_(ByteCount) PVOID UserBuffer
+    );
+
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE, CdCreateUserMdl)
 #pragma alloc_text(PAGE, CdMultipleAsync)
@@ -217,8 +227,10 @@ CdReadDirDataThroughCache (
 #pragma alloc_text(PAGE, CdWaitSync)
 #pragma alloc_text(PAGE, CdReadDirDataThroughCache)
 #pragma alloc_text(PAGE, CdFreeDirCache)
+#pragma alloc_text(PAGE, CdFreeReadAhead)
 #pragma alloc_text(PAGE, CdLbnToMmSsFf)
 #pragma alloc_text(PAGE, CdHijackIrpAndFlushDevice)
+#pragma alloc_text(PAGE, CdReadAheadNonCachedRead)
 #endif
 
 
@@ -384,6 +396,26 @@ Return Value:
         return STATUS_SUCCESS;
     }
 
+    //
+    //  Sequential non-cached user reads of a file may be satisfied from
+    //  the readahead buffer for the Fcb.  Paging Io is left to Cc's own
+    //  readahead.
+    //
+
+    if ((SafeNodeType( Fcb ) == CDFS_NTC_FCB_DATA) &&
+        (Fcb != Fcb->Vcb->VolumeDasdFcb) &&
+        !FlagOn( IrpContext->Irp->Flags, IRP_PAGING_IO ) &&
+        (SectorOffset( StartingOffset ) == 0) &&
+        (Fcb->Vcb->VcbCondition == VcbMounted) &&
+        CdReadAheadNonCachedRead( IrpContext,
+                                  Fcb,
+                                  StartingOffset,
+                                  ByteCount,
+                                  UserBuffer )) {
+
+        return STATUS_SUCCESS;
+    }
+
     //
     //  If we're going to use the sector cache for this request, then
     //  mark the request waitable.
@@ -4173,3 +4205,299 @@ Return Value:
 }
 
 
+VOID
+CdFreeReadAhead (
+    _In_ PIRP_CONTEXT IrpContext,
+    _Inout_ PFCB Fcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees the non-cached readahead state for a data Fcb, if
+    any was allocated.
+
+Arguments:
+
+    Fcb - Data Fcb being deleted.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER( IrpContext );
+
+    if (Fcb->ReadAhead != NULL) {
+
+        CdFreePool( &Fcb->ReadAhead->Buffer );
+        ExDeleteResourceLite( &Fcb->ReadAhead->Resource );
+        CdFreePool( &Fcb->ReadAhead );
+    }
+}
+
+
+//
+//  Local support routine
+//
+
+_Requires_lock_held_(_Global_critical_region_)
+BOOLEAN
+CdReadAheadNonCachedRead (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PFCB Fcb,
+    _In_ LONGLONG StartingOffset,
+    _In_ ULONG ByteCount,
+    _Out_writes_bytes_(ByteCount) PVOID UserBuffer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called for a sector aligned non-cached user read of a
+    data file.  If the range is in the readahead buffer for the Fcb we copy
+    it from there.  Otherwise we update the sequential detector and, if this
+    is one of a run of sequential reads and we can wait, read the current
+    window from the start of the request into the buffer in a single Io and
+    copy the caller's portion out.
+
+    Nothing here is required for correctness.  Any failure, including a
+    failed fill, simply returns FALSE and the caller performs the read
+    normally so that errors are reported in the usual way.
+
+Arguments:
+
+    Fcb - Data Fcb for the file being read.
+
+    StartingOffset - Sector aligned file offset to read from.
+
+    ByteCount - Number of bytes to read, integral sectors.
+
+    UserBuffer - Mapped user buffer.
+
+Return Value:
+
+    BOOLEAN - TRUE if the read was satisfied here, FALSE if the caller should
+        perform the read.
+
+--*/
+
+{
+    PCD_READ_AHEAD ReadAhead;
+    PIRP Irp;
+    KEVENT Event;
+    IO_STATUS_BLOCK Iosb;
+    NTSTATUS Status;
+
+    LONGLONG DiskOffset;
+    ULONG RunByteCount;
+    ULONG FillLength;
+
+    BOOLEAN Satisfied = FALSE;
+
+    PAGED_CODE();
+
+    //
+    //  Allocate the readahead state on first use.
+    //
+
+    if (Fcb->ReadAhead == NULL) {
+
+        ReadAhead = ExAllocatePoolWithTag( CdNonPagedPool,
+                                           sizeof( CD_READ_AHEAD ),
+                                           TAG_READ_AHEAD );
+
+        if (ReadAhead == NULL) {
+
+            return FALSE;
+        }
+
+        RtlZeroMemory( ReadAhead, sizeof( CD_READ_AHEAD ));
+        ExInitializeResourceLite( &ReadAhead->Resource );
+        ReadAhead->Window = CD_READ_AHEAD_MIN_WINDOW;
+
+        if (InterlockedCompareExchangePointer( (PVOID *) &Fcb->ReadAhead,
+                                               ReadAhead,
+                                               NULL ) != NULL) {
+
+            ExDeleteResourceLite( &ReadAhead->Resource );
+            CdFreePool( &ReadAhead );
+        }
+    }
+
+    ReadAhead = Fcb->ReadAhead;
+
+    //
+    //  Don't wait behind another reader's fill.
+    //
+
+    if (!ExAcquireResourceExclusiveLite( &ReadAhead->Resource, FALSE )) {
+
+        return FALSE;
+    }
+
+    try {
+
+        //
+        //  Check for a hit in the current buffer.
+        //
+
+        if ((ReadAhead->BufferLength != 0) &&
+            (StartingOffset >= ReadAhead->BufferOffset) &&
+            (StartingOffset + ByteCount <= ReadAhead->BufferOffset + ReadAhead->BufferLength)) {
+
+            RtlCopyMemory( UserBuffer,
+                           Add2Ptr( ReadAhead->Buffer,
+                                    (ULONG) (StartingOffset - ReadAhead->BufferOffset),
+                                    PVOID ),
+                           ByteCount );
+
+            ReadAhead->NextOffset = StartingOffset + ByteCount;
+            ReadAhead->BufferUsed = TRUE;
+            ReadAhead->Hits += 1;
+#if DBG
+            InterlockedIncrement( (LONG*)&Fcb->Vcb->ReadAheadHits );
+#endif
+            try_return( Satisfied = TRUE );
+        }
+
+        //
+        //  Update the sequential detector.  A random read starts over with
+        //  the smallest window.
+        //
+
+        if (StartingOffset == ReadAhead->NextOffset) {
+
+            ReadAhead->SequentialCount += 1;
+
+        } else {
+
+            ReadAhead->SequentialCount = 0;
+            ReadAhead->Window = CD_READ_AHEAD_MIN_WINDOW;
+        }
+
+        ReadAhead->NextOffset = StartingOffset + ByteCount;
+
+        //
+        //  We only fill for synchronous requests which are part of a
+        //  sequential run.
+        //
+
+        if (!FlagOn( IrpContext->Flags, IRP_CONTEXT_FLAG_WAIT ) ||
+            (ReadAhead->SequentialCount < CD_READ_AHEAD_TRIGGER)) {
+
+            try_return( NOTHING );
+        }
+
+        //
+        //  Grow the window if the previous fill was used.
+        //
+
+        if (ReadAhead->BufferUsed &&
+            (ReadAhead->Window < CD_READ_AHEAD_MAX_WINDOW)) {
+
+            ReadAhead->Window *= 2;
+        }
+
+        //
+        //  The fill must be contiguous on the disk, and has to be larger
+        //  than the request to be worth doing.
+        //
+
+        CdLookupAllocation( IrpContext,
+                            Fcb,
+                            StartingOffset,
+                            &DiskOffset,
+                            &RunByteCount );
+
+        FillLength = ReadAhead->Window;
+
+        if (FillLength > RunByteCount) {
+
+            FillLength = SectorTruncate( RunByteCount );
+        }
+
+        if (FillLength <= ByteCount) {
+
+            try_return( NOTHING );
+        }
+
+        if (ReadAhead->Buffer == NULL) {
+
+            ReadAhead->Buffer = ExAllocatePoolWithTag( CdPagedPool,
+                                                       CD_READ_AHEAD_MAX_WINDOW,
+                                                       TAG_READ_AHEAD );
+
+            if (ReadAhead->Buffer == NULL) {
+
+                try_return( NOTHING );
+            }
+        }
+
+        //
+        //  Discard the old contents and read the window.  We don't override
+        //  verify here, a media change fails the fill and the caller's read
+        //  will see it.
+        //
+
+        ReadAhead->BufferLength = 0;
+        ReadAhead->BufferUsed = FALSE;
+
+        KeInitializeEvent( &Event, NotificationEvent, FALSE );
+
+        Irp = IoBuildSynchronousFsdRequest( IRP_MJ_READ,
+                                            Fcb->Vcb->TargetDeviceObject,
+                                            ReadAhead->Buffer,
+                                            FillLength,
+                                            (PLARGE_INTEGER) &DiskOffset,
+                                            &Event,
+                                            &Iosb );
+
+        if (Irp == NULL) {
+
+            try_return( NOTHING );
+        }
+
+        Status = IoCallDriver( Fcb->Vcb->TargetDeviceObject, Irp );
+
+        if (Status == STATUS_PENDING) {
+
+            (VOID)KeWaitForSingleObject( &Event,
+                                         Executive,
+                                         KernelMode,
+                                         FALSE,
+                                         NULL );
+
+            Status = Iosb.Status;
+        }
+
+        if (!NT_SUCCESS( Status ) || (Iosb.Information != FillLength)) {
+
+            try_return( NOTHING );
+        }
+
+        ReadAhead->BufferOffset = StartingOffset;
+        ReadAhead->BufferLength = FillLength;
+        ReadAhead->Fills += 1;
+#if DBG
+        InterlockedIncrement( (LONG*)&Fcb->Vcb->ReadAheadFills );
+#endif
+
+        RtlCopyMemory( UserBuffer, ReadAhead->Buffer, ByteCount );
+        Satisfied = TRUE;
+
+    try_exit:  NOTHING;
+    } finally {
+
+        ExReleaseResourceLite( &ReadAhead->Resource );
+    }
+
+    return Satisfied;
+}
+
@@ -105,13 +105,38 @@ CdCheckForXAExtent (
     _Inout_ PDIRENT Dirent
     );
 
+ULONG
+CdHashName (
+    _In_ PUNICODE_STRING Name
+    );
+
+VOID
+CdBuildNameTable (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PFCB Fcb
+    );
+
+BOOLEAN
+CdFindFileInNameTable (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PFCB Fcb,
+    _In_ PCD_NAME Name,
+    _In_ BOOLEAN IgnoreCase,
+    _Inout_ PFILE_ENUM_CONTEXT FileContext,
+    _Out_ PCD_NAME *MatchingName
+    );
+
 #ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, CdBuildNameTable)
 #pragma alloc_text(PAGE, CdCheckForXAExtent)
 #pragma alloc_text(PAGE, CdCheckRawDirentBounds)
 #pragma alloc_text(PAGE, CdCleanupFileContext)
 #pragma alloc_text(PAGE, CdFindFile)
+#pragma alloc_text(PAGE, CdFindFileInNameTable)
 #pragma alloc_text(PAGE, CdFindDirectory)
 #pragma alloc_text(PAGE, CdFindFileByShortName)
+#pragma alloc_text(PAGE, CdFreeNameTable)
+#pragma alloc_text(PAGE, CdHashName)
 #pragma alloc_text(PAGE, CdLookupDirent)
 #pragma alloc_text(PAGE, CdLookupLastFileDirent)
 #pragma alloc_text(PAGE, CdLookupNextDirent)
@@ -881,6 +906,32 @@ Return Value:
 
     ShortNameDirentOffset = CdShortNameDirentOffset( IrpContext, &Name->FileName );
 
+    //
+    //  If this can't be a generated short name then use the name table for
+    //  this directory, building it on the first lookup.  A short name match
+    //  depends on the position of the dirent so those still take the scan
+    //  below.
+    //
+
+    if (ShortNameDirentOffset == MAXULONG) {
+
+        if ((Fcb->NameTable == NULL) &&
+            !FlagOn( Fcb->FcbState, FCB_STATE_NO_NAME_TABLE )) {
+
+            CdBuildNameTable( IrpContext, Fcb );
+        }
+
+        if (Fcb->NameTable != NULL) {
+
+            return CdFindFileInNameTable( IrpContext,
+                                          Fcb,
+                                          Name,
+                                          IgnoreCase,
+                                          FileContext,
+                                          MatchingName );
+        }
+    }
+
     //
     //  Position ourselves at the first entry.
     //
@@ -1867,4 +1918,383 @@ Return Value:
 }
 
 
+VOID
+CdFreeNameTable (
+    _In_ PIRP_CONTEXT IrpContext,
+    _Inout_ PFCB Fcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called to free the directory name table for an index Fcb,
+    if one has been built.
+
+Arguments:
+
+    Fcb - Fcb for the directory.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER( IrpContext );
+
+    if (Fcb->NameTable != NULL) {
+
+        CdFreePool( &Fcb->NameTable->Buckets );
+        CdFreePool( &Fcb->NameTable->Entries );
+        CdFreePool( &Fcb->NameTable );
+    }
+
+    return;
+}
+
+
+//
+//  Local support routine
+//
+
+ULONG
+CdHashName (
+    _In_ PUNICODE_STRING Name
+    )
+
+/*++
+
+Routine Description:
+
+    This routine computes the hash used in the directory name table.  The
+    name is upcased as we go so the same hash serves case sensitive and
+    case insensitive lookups.
+
+Arguments:
+
+    Name - Name portion of a CdName, without the version string.
+
+Return Value:
+
+    ULONG - Hash of the upcased name.
+
+--*/
+
+{
+    ULONG Hash = 0x811c9dc5;
+    ULONG Index;
+
+    PAGED_CODE();
+
+    for (Index = 0; Index < Name->Length / sizeof( WCHAR ); Index += 1) {
+
+        Hash ^= RtlUpcaseUnicodeChar( Name->Buffer[Index] );
+        Hash *= 0x01000193;
+    }
+
+    return Hash;
+}
+
+
+//
+//  Local support routine
+//
+
+VOID
+CdBuildNameTable (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PFCB Fcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called to build the name table for a directory.  We walk
+    the initial dirent of every file in the directory once, decode its name
+    and remember its offset and name hash.  Directories and associated files
+    are skipped just as they are in CdFindFile.
+
+    The table is only a cache.  If the directory is small or we can't get
+    the pool for it we mark the Fcb so that we don't try again, and lookups
+    continue to scan the directory.  The caller has the Fcb exclusive.
+
+Arguments:
+
+    Fcb - Fcb for the directory.  The stream file has already been created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    FILE_ENUM_CONTEXT FileContext;
+    PDIRENT Dirent;
+
+    PCD_NAME_TABLE NameTable = NULL;
+    PCD_NAME_TABLE_ENTRY NewEntries;
+    ULONG EntryMax = 0;
+    ULONG BucketCount = 16;
+    ULONG Index;
+    ULONG Bucket;
+
+    BOOLEAN Complete = FALSE;
+
+    PAGED_CODE();
+
+    //
+    //  Small directories are cheap enough to scan.
+    //
+
+    if (Fcb->FileSize.QuadPart <= CD_NAME_TABLE_MIN_DIR_SIZE) {
+
+        SetFlag( Fcb->FcbState, FCB_STATE_NO_NAME_TABLE );
+        return;
+    }
+
+    CdInitializeFileContext( IrpContext, &FileContext );
+
+    try {
+
+        NameTable = ExAllocatePoolWithTag( CdPagedPool,
+                                           sizeof( CD_NAME_TABLE ),
+                                           TAG_NAME_TABLE );
+
+        if (NameTable == NULL) {
+
+            try_leave( NOTHING );
+        }
+
+        RtlZeroMemory( NameTable, sizeof( CD_NAME_TABLE ));
+
+        //
+        //  Position ourselves at the first entry and walk the directory.
+        //
+
+        CdLookupInitialFileDirent( IrpContext, Fcb, &FileContext, Fcb->StreamOffset );
+
+        do {
+
+            Dirent = &FileContext.InitialDirent->Dirent;
+
+            if (FlagOn( Dirent->DirentFlags, CD_ATTRIBUTE_ASSOC | CD_ATTRIBUTE_DIRECTORY )) {
+
+                continue;
+            }
+
+            CdUpdateDirentName( IrpContext, Dirent, FALSE );
+
+            if (FlagOn( Dirent->Flags, DIRENT_FLAG_CONSTANT_ENTRY )) {
+
+                continue;
+            }
+
+            //
+            //  Grow the entry array if it is full.
+            //
+
+            if (NameTable->EntryCount == EntryMax) {
+
+                EntryMax = (EntryMax == 0) ? 64 : (EntryMax * 2);
+
+                NewEntries = ExAllocatePoolWithTag( CdPagedPool,
+                                                    EntryMax * sizeof( CD_NAME_TABLE_ENTRY ),
+                                                    TAG_NAME_TABLE );
+
+                if (NewEntries == NULL) {
+
+                    try_leave( NOTHING );
+                }
+
+                if (NameTable->Entries != NULL) {
+
+                    RtlCopyMemory( NewEntries,
+                                   NameTable->Entries,
+                                   NameTable->EntryCount * sizeof( CD_NAME_TABLE_ENTRY ));
+
+                    CdFreePool( &NameTable->Entries );
+                }
+
+                NameTable->Entries = NewEntries;
+            }
+
+            NameTable->Entries[NameTable->EntryCount].DirentOffset = Dirent->DirentOffset;
+            NameTable->Entries[NameTable->EntryCount].Hash = CdHashName( &Dirent->CdFileName.FileName );
+            NameTable->Entries[NameTable->EntryCount].Next = CD_NAME_TABLE_NIL;
+            NameTable->EntryCount += 1;
+
+        } while (CdLookupNextInitialFileDirent( IrpContext, Fcb, &FileContext ));
+
+        //
+        //  Now size and fill in the buckets.  We insert from the end of the
+        //  directory so that each chain ends up in directory order, and the
+        //  first match on a chain is the one a scan would have found.
+        //
+
+        while (BucketCount < NameTable->EntryCount) {
+
+            BucketCount <<= 1;
+        }
+
+        NameTable->Buckets = ExAllocatePoolWithTag( CdPagedPool,
+                                                    BucketCount * sizeof( ULONG ),
+                                                    TAG_NAME_TABLE );
+
+        if (NameTable->Buckets == NULL) {
+
+            try_leave( NOTHING );
+        }
+
+        NameTable->BucketMask = BucketCount - 1;
+
+        for (Bucket = 0; Bucket < BucketCount; Bucket += 1) {
+
+            NameTable->Buckets[Bucket] = CD_NAME_TABLE_NIL;
+        }
+
+        for (Index = NameTable->EntryCount; Index-- != 0; ) {
+
+            Bucket = NameTable->Entries[Index].Hash & NameTable->BucketMask;
+
+            NameTable->Entries[Index].Next = NameTable->Buckets[Bucket];
+            NameTable->Buckets[Bucket] = Index;
+        }
+
+        Complete = TRUE;
+
+    } finally {
+
+        CdCleanupFileContext( IrpContext, &FileContext );
+
+        if (Complete) {
+
+            Fcb->NameTable = NameTable;
+
+        } else {
+
+            if (NameTable != NULL) {
+
+                CdFreePool( &NameTable->Buckets );
+                CdFreePool( &NameTable->Entries );
+                CdFreePool( &NameTable );
+            }
+
+            //
+            //  Don't retry if we simply ran out of pool.  If we raised then
+            //  the scan in our caller will see the same problem.
+            //
+
+            if (!AbnormalTermination()) {
+
+                SetFlag( Fcb->FcbState, FCB_STATE_NO_NAME_TABLE );
+            }
+        }
+    }
+
+    return;
+}
+
+
+//
+//  Local support routine
+//
+
+BOOLEAN
+CdFindFileInNameTable (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PFCB Fcb,
+    _In_ PCD_NAME Name,
+    _In_ BOOLEAN IgnoreCase,
+    _Inout_ PFILE_ENUM_CONTEXT FileContext,
+    _Out_ PCD_NAME *MatchingName
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is the name table version of the search in CdFindFile.  We
+    only decode the dirents on the hash chain for the name, verifying each with
+    the same comparison the scan uses.  The input name is not a possible
+    generated short name.
+
+Arguments:
+
+    Fcb - Fcb for the directory being searched.  It has a name table.
+
+    Name - Name to search for.
+
+    IgnoreCase - Indicates the case of the search.
+
+    FileContext - File context to use for the search.  This has already been
+        initialized.
+
+    MatchingName - Pointer to buffer containing matching name.
+
+Return Value:
+
+    BOOLEAN - TRUE if matching entry is found, FALSE otherwise.
+
+--*/
+
+{
+    PCD_NAME_TABLE NameTable = Fcb->NameTable;
+    PCD_NAME_TABLE_ENTRY Entry = NULL;
+    PDIRENT Dirent;
+    ULONG Hash;
+    ULONG Index;
+
+    PAGED_CODE();
+
+    Hash = CdHashName( &Name->FileName );
+
+    for (Index = NameTable->Buckets[Hash & NameTable->BucketMask];
+         Index != CD_NAME_TABLE_NIL;
+         Index = Entry->Next) {
+
+        Entry = &NameTable->Entries[Index];
+
+        if (Entry->Hash != Hash) {
+
+            continue;
+        }
+
+        //
+        //  Drop any sector we mapped for an earlier candidate and position
+        //  at this dirent.
+        //
+
+        CdCleanupDirContext( IrpContext, &FileContext->InitialDirent->DirContext );
+
+        CdLookupInitialFileDirent( IrpContext, Fcb, FileContext, Entry->DirentOffset );
+
+        Dirent = &FileContext->InitialDirent->Dirent;
+
+        CdUpdateDirentName( IrpContext, Dirent, IgnoreCase );
+
+        if (CdIsNameInExpression( IrpContext,
+                                  &Dirent->CdCaseFileName,
+                                  Name,
+                                  0,
+                                  TRUE )) {
+
+            *MatchingName = &Dirent->CdCaseFileName;
+
+            //
+            //  Collect all of the dirents for the file.
+            //
+
+            CdLookupLastFileDirent( IrpContext, Fcb, FileContext );
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
 
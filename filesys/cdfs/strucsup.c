@@ -2493,6 +2493,8 @@ Return Value:
             Vcb->PathTableFcb = NULL;
         }
 
+        CdFreeNameTable( IrpContext, Fcb );
+
         CdDeallocateFcbIndex( IrpContext, Fcb );
         break;
 
@@ -2505,6 +2507,8 @@ Return Value:
 
         FsRtlUninitializeOplock( CdGetFcbOplock(Fcb) );
 
+        CdFreeReadAhead( IrpContext, Fcb );
+
         if (Fcb == Fcb->Vcb->VolumeDasdFcb) {
 
             Vcb = Fcb->Vcb;
@@ -35,6 +35,30 @@ Abstract:
 
 #define FAT_PREFETCH_PAGE_COUNT          0x100
 
+//
+//  Define the prefetch page count used while walking the FAT chain of a
+//  file.  This is smaller since a chain may wander around the FAT.
+//
+
+#define FAT_LOOKUP_PREFETCH_PAGE_COUNT   0x10
+
+//
+//  Once a walk of a FAT chain has found this many runs, the file is
+//  fragmented enough that we finish the walk and load the whole Mcb,
+//  rather than stop at the run that holds the Vbo we were asked about.
+//
+
+#define FAT_LOOKUP_FULL_WALK_RUNS        16
+
+//
+//  Define the range of run counts for which we keep a closed file's
+//  allocation in the extent cache.  Files with fewer runs are cheap to
+//  look up again.
+//
+
+#define FAT_EXTENT_CACHE_MIN_RUNS        8
+#define FAT_EXTENT_CACHE_MAX_RUNS        4096
+
 //
 //  Local support routine prototypes
 //
@@ -214,6 +238,39 @@ FatLogOf(
     }                                                                                       \
 }
 
+//
+//  VOID
+//  FatReserveVolumeClusters  (
+//      IN PVCB Vcb,
+//      IN ULONG FatIndex,
+//      IN ULONG ClusterCount
+//      );
+//
+//  VOID
+//  FatUnreserveVolumeClusters  (
+//      IN PVCB Vcb,
+//      IN ULONG FatIndex,
+//      IN ULONG ClusterCount
+//      );
+//
+//  These take volume relative cluster numbers, and are noops if the volume
+//  has no volume cluster bitmap.
+//
+
+#define FatReserveVolumeClusters(VCB,FAT_INDEX,CLUSTER_COUNT) {                             \
+    if ((VCB)->VolumeClusterBitMap.Buffer != NULL) {                                        \
+        NT_ASSERT( (FAT_INDEX) + (CLUSTER_COUNT) - 2 <= (VCB)->VolumeClusterBitMap.SizeOfBitMap );\
+        RtlSetBits(&(VCB)->VolumeClusterBitMap,(FAT_INDEX)-2,(CLUSTER_COUNT));              \
+    }                                                                                       \
+}
+
+#define FatUnreserveVolumeClusters(VCB,FAT_INDEX,CLUSTER_COUNT) {                           \
+    if ((VCB)->VolumeClusterBitMap.Buffer != NULL) {                                        \
+        NT_ASSERT( (FAT_INDEX) + (CLUSTER_COUNT) - 2 <= (VCB)->VolumeClusterBitMap.SizeOfBitMap );\
+        RtlClearBits(&(VCB)->VolumeClusterBitMap,(FAT_INDEX)-2,(CLUSTER_COUNT));            \
+    }                                                                                       \
+}
+
 //
 //  ULONG
 //  FatFindFreeClusterRun (
@@ -246,6 +303,14 @@ FatLogOf(
 
 #define MAX_CLUSTER_BITMAP_SIZE         (1 << 16)
 
+//
+//  FAT32: Define the largest volume, in clusters, for which we will keep a
+//  bitmap of the whole volume in addition to the window bitmap.  This is a
+//  16MB bitmap.
+//
+
+#define MAX_VOLUME_BITMAP_SIZE          (1 << 27)
+
 //
 //  Calculate the window a given cluster number is in.
 //
@@ -262,7 +327,10 @@ FatLogOf(
 #pragma alloc_text(PAGE, FatLookupFatEntry)
 #pragma alloc_text(PAGE, FatLookupFileAllocation)
 #pragma alloc_text(PAGE, FatLookupFileAllocationSize)
+#pragma alloc_text(PAGE, FatLoadFileExtents)
 #pragma alloc_text(PAGE, FatMergeAllocation)
+#pragma alloc_text(PAGE, FatPurgeExtentCache)
+#pragma alloc_text(PAGE, FatSaveFileExtents)
 #pragma alloc_text(PAGE, FatSetFatEntry)
 #pragma alloc_text(PAGE, FatSetFatRun)
 #pragma alloc_text(PAGE, FatSetupAllocationSupport)
@@ -468,12 +536,39 @@ Arguments:
                              NULL,
                              0 );
 
+        RtlInitializeBitMap( &Vcb->VolumeClusterBitMap,
+                             NULL,
+                             0 );
+
         //
         //  Chose a FAT window to begin operation in.
         //
 
         if (Vcb->NumberOfWindows > 1) {
 
+            //
+            //  The scan below reads the whole FAT anyway, so have it fill in a
+            //  bitmap of the whole volume as well.  This is only an optimization,
+            //  so just do without it if the volume is too large or we cannot get
+            //  the pool.
+            //
+
+            if (Vcb->AllocationSupport.NumberOfClusters <= MAX_VOLUME_BITMAP_SIZE) {
+
+                PULONG VolumeBitMapBuffer;
+
+                VolumeBitMapBuffer = ExAllocatePoolWithTag( PagedPool,
+                                                            ((Vcb->AllocationSupport.NumberOfClusters + 31) / 32) * 4,
+                                                            TAG_FAT_VOLUME_BITMAP );
+
+                if (VolumeBitMapBuffer != NULL) {
+
+                    RtlInitializeBitMap( &Vcb->VolumeClusterBitMap,
+                                         VolumeBitMapBuffer,
+                                         Vcb->AllocationSupport.NumberOfClusters );
+                }
+            }
+
             //
             //  Read the fat and count up free clusters.  We bias by the two reserved
             //  entries in the FAT.
@@ -598,12 +693,24 @@ Return Value:
         Vcb->FreeClusterBitMap.Buffer = NULL;
     }
 
+    if ( Vcb->VolumeClusterBitMap.Buffer != NULL ) {
+
+        ExFreePool( Vcb->VolumeClusterBitMap.Buffer );
+        Vcb->VolumeClusterBitMap.Buffer = NULL;
+    }
+
     //
     //  And remove all the runs in the dirty fat Mcb
     //
 
     FatRemoveMcbEntry( Vcb, &Vcb->DirtyFatMcb, 0, 0xFFFFFFFF );
 
+    //
+    //  What we remember of closed files' allocation is no longer to be trusted.
+    //
+
+    FatPurgeExtentCache( Vcb );
+
     DebugTrace(-1, Dbg, "FatTearDownAllocationSupport -> (VOID)\n", 0);
 
     UNREFERENCED_PARAMETER( IrpContext );
@@ -665,6 +772,8 @@ Arguments:
 
     BOOLEAN LastCluster;
     ULONG Runs;
+    ULONG RunsThisWalk = 0;
+    BOOLEAN WalkToEnd = FALSE;
 
     PVCB Vcb;
     FAT_ENTRY FatEntry;
@@ -673,6 +782,13 @@ Arguments:
 
     FAT_ENUMERATION_CONTEXT Context;
 
+#if (NTDDI_VERSION >= NTDDI_WIN8)
+    ULONG FatPage;
+    ULONG FatPages;
+    ULONG PrefetchStartPage = 0;
+    ULONG PrefetchEndPage = 0;
+#endif
+
     PAGED_CODE();
 
     Vcb = FcbOrDcb->Vcb;
@@ -824,8 +940,45 @@ Arguments:
         //  hit a noncontiguity beyond the desired Vbo, or the last cluster.
         //
 
+#if (NTDDI_VERSION >= NTDDI_WIN8)
+        FatPages = (FatReservedBytes(&Vcb->Bpb) + FatBytesPerFat(&Vcb->Bpb) + (PAGE_SIZE - 1)) / PAGE_SIZE;
+#endif
+
         while ( !LastCluster ) {
 
+#if (NTDDI_VERSION >= NTDDI_WIN8)
+
+            //
+            //  When the chain leaves the stretch of FAT we last prefetched, prefetch
+            //  the pages ahead of it.  We don't bother for the page we start on, so
+            //  short chains cost no more than before.  The 12 bit FAT is read whole.
+            //
+
+            if ((Vcb->AllocationSupport.FatIndexBitSize != 12) &&
+                FlagOn( IrpContext->Flags, IRP_CONTEXT_FLAG_WAIT ) &&
+                (IrpContext->OriginatingIrp != NULL)) {
+
+                FatPage = (FatReservedBytes(&Vcb->Bpb) +
+                           FatEntry * (Vcb->AllocationSupport.FatIndexBitSize / 8)) / PAGE_SIZE;
+
+                if (PrefetchEndPage == 0) {
+
+                    PrefetchStartPage = FatPage;
+                    PrefetchEndPage = FatPage + 1;
+
+                } else if ((FatPage < PrefetchStartPage) || (FatPage >= PrefetchEndPage)) {
+
+                    PrefetchStartPage = FatPage;
+                    PrefetchEndPage = FatMin( FatPage + FAT_LOOKUP_PREFETCH_PAGE_COUNT, FatPages );
+
+                    FatPrefetchPages( IrpContext,
+                                      Vcb->VirtualVolumeFile,
+                                      PrefetchStartPage,
+                                      PrefetchEndPage - PrefetchStartPage );
+                }
+            }
+#endif
+
             //
             //  Get the next fat entry, and update our Current variables.
             //
@@ -995,6 +1148,16 @@ Arguments:
                                         CurrentVbo - FirstVboOfCurrentRun );
 
                         Runs += 1;
+
+                        //
+                        //  If this file is badly fragmented, the next lookup past
+                        //  here would only walk on from where we stop.  Do it now.
+                        //
+
+                        if (++RunsThisWalk == FAT_LOOKUP_FULL_WALK_RUNS) {
+
+                            WalkToEnd = TRUE;
+                        }
                     }
 
                     //
@@ -1005,7 +1168,7 @@ Arguments:
                     //  First*boOfCurrentRun, and continue.
                     //
 
-                    if (CurrentVbo > Vbo) {
+                    if ((CurrentVbo > Vbo) && !WalkToEnd) {
 
                         LastCluster = TRUE;
 
@@ -1029,6 +1192,22 @@ Arguments:
             } // switch()
         } // while()
 
+        //
+        //  If we walked on to the end of the chain, the desired Vbo may be in
+        //  a run we already put in the Mcb.
+        //
+
+        if (WalkToEnd && (Vbo < FirstVboOfCurrentRun)) {
+
+            *EndOnMax = FALSE;
+
+            *Allocated = FatLookupMcbEntry( Vcb, &FcbOrDcb->Mcb, Vbo, Lbo, ByteCount, Index );
+
+            NT_ASSERT( *Allocated );
+
+            try_return( NOTHING );
+        }
+
         //
         //  Load up the return parameters.
         //
@@ -1740,6 +1919,287 @@ Arguments:
     return;
 }
 
+
+VOID
+FatSaveFileExtents (
+    IN PIRP_CONTEXT IrpContext,
+    IN PFCB Fcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called as an Fcb is deleted, and records the runs in its
+    Mcb in the volume's extent cache.  We only do this for fragmented files
+    whose Mcb describes all of their allocation.
+
+    This is only an optimization, so we quietly do nothing if anything is
+    amiss, including a lack of pool.
+
+Arguments:
+
+    Fcb - Supplies the Fcb being deleted
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PVCB Vcb = Fcb->Vcb;
+    PFAT_EXTENT_CACHE_ENTRY Entry;
+    PFAT_EXTENT_CACHE_ENTRY Victim = NULL;
+    PLIST_ENTRY Links;
+
+    VBO LastVbo;
+    LBO LastLbo;
+    ULONG Index;
+    ULONG Run;
+
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER( IrpContext );
+
+    //
+    //  The allocation must be fully known and stable.  Directories are left
+    //  alone, they keep their Dcbs around anyway.
+    //
+
+    if ((FatData.ExtentCacheDepth == 0) ||
+        (Fcb->Header.NodeTypeCode != FAT_NTC_FCB) ||
+        (Fcb->FcbCondition != FcbGood) ||
+        (Vcb->VcbCondition != VcbGood) ||
+        (Fcb->FirstClusterOfFile == 0) ||
+        FlagOn( Fcb->FcbState, FCB_STATE_DELETE_ON_CLOSE ) ||
+        FlagOn( Vcb->VcbState, VCB_STATE_FLAG_LOCKED ) ||
+        (Fcb->Header.AllocationSize.QuadPart == FCB_LOOKUP_ALLOCATIONSIZE_HINT) ||
+        (Fcb->Header.AllocationSize.HighPart != 0)) {
+
+        return;
+    }
+
+    if (!FatLookupLastMcbEntry( Vcb, &Fcb->Mcb, &LastVbo, &LastLbo, &Index ) ||
+        (LastVbo + 1 != Fcb->Header.AllocationSize.LowPart)) {
+
+        return;
+    }
+
+    if ((Index + 1 < FAT_EXTENT_CACHE_MIN_RUNS) ||
+        (Index + 1 > FAT_EXTENT_CACHE_MAX_RUNS)) {
+
+        return;
+    }
+
+    Entry = ExAllocatePoolWithTag( PagedPool,
+                                   FIELD_OFFSET( FAT_EXTENT_CACHE_ENTRY, Runs ) +
+                                        (Index + 1) * sizeof( FAT_EXTENT ),
+                                   TAG_FAT_EXTENT_CACHE );
+
+    if (Entry == NULL) {
+
+        return;
+    }
+
+    Entry->FirstClusterOfFile = Fcb->FirstClusterOfFile;
+    Entry->RunCount = Index + 1;
+
+    for (Run = 0; Run < Entry->RunCount; Run += 1) {
+
+        if (!FatGetNextMcbEntry( Vcb,
+                                 &Fcb->Mcb,
+                                 Run,
+                                 &Entry->Runs[Run].Vbo,
+                                 &Entry->Runs[Run].Lbo,
+                                 &Entry->Runs[Run].ByteCount ) ||
+            (Entry->Runs[Run].Lbo == 0)) {
+
+            ExFreePool( Entry );
+            return;
+        }
+    }
+
+    ExAcquireFastMutex( &Vcb->ExtentCacheMutex );
+
+    //
+    //  There should not be an entry for this file already, since we take the
+    //  entry out when the Fcb is created.  Replace it if there is.
+    //
+
+    for (Links = Vcb->ExtentCacheList.Flink;
+         Links != &Vcb->ExtentCacheList;
+         Links = Links->Flink) {
+
+        Victim = CONTAINING_RECORD( Links, FAT_EXTENT_CACHE_ENTRY, Links );
+
+        if (Victim->FirstClusterOfFile == Entry->FirstClusterOfFile) {
+
+            RemoveEntryList( &Victim->Links );
+            Vcb->ExtentCacheCount -= 1;
+            break;
+        }
+
+        Victim = NULL;
+    }
+
+    InsertHeadList( &Vcb->ExtentCacheList, &Entry->Links );
+    Vcb->ExtentCacheCount += 1;
+
+    //
+    //  If the cache is now too big, drop the least recently used entry.
+    //
+
+    if ((Victim == NULL) &&
+        (Vcb->ExtentCacheCount > FatData.ExtentCacheDepth)) {
+
+        Links = RemoveTailList( &Vcb->ExtentCacheList );
+        Victim = CONTAINING_RECORD( Links, FAT_EXTENT_CACHE_ENTRY, Links );
+        Vcb->ExtentCacheCount -= 1;
+    }
+
+    ExReleaseFastMutex( &Vcb->ExtentCacheMutex );
+
+    if (Victim != NULL) {
+
+        ExFreePool( Victim );
+    }
+}
+
+
+VOID
+FatLoadFileExtents (
+    IN PIRP_CONTEXT IrpContext,
+    IN PFCB Fcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called as an Fcb is created for a file with allocation.
+    If the volume's extent cache has an entry for the file, we take it out
+    of the cache and load its runs into the new Fcb's Mcb.
+
+    The allocation size is left to be looked up.  Since the Mcb now reaches
+    the last cluster of the file, that only costs a single FAT entry.
+
+Arguments:
+
+    Fcb - Supplies the Fcb being created
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PVCB Vcb = Fcb->Vcb;
+    PFAT_EXTENT_CACHE_ENTRY Entry = NULL;
+    PLIST_ENTRY Links;
+    ULONG Run;
+
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER( IrpContext );
+
+    NT_ASSERT( Fcb->FirstClusterOfFile != 0 );
+
+    //
+    //  An unsafe test is fine here, we're only saving ourselves the mutex.
+    //
+
+    if (Vcb->ExtentCacheCount == 0) {
+
+        return;
+    }
+
+    ExAcquireFastMutex( &Vcb->ExtentCacheMutex );
+
+    for (Links = Vcb->ExtentCacheList.Flink;
+         Links != &Vcb->ExtentCacheList;
+         Links = Links->Flink) {
+
+        Entry = CONTAINING_RECORD( Links, FAT_EXTENT_CACHE_ENTRY, Links );
+
+        if (Entry->FirstClusterOfFile == Fcb->FirstClusterOfFile) {
+
+            RemoveEntryList( &Entry->Links );
+            Vcb->ExtentCacheCount -= 1;
+            break;
+        }
+
+        Entry = NULL;
+    }
+
+    ExReleaseFastMutex( &Vcb->ExtentCacheMutex );
+
+    if (Entry == NULL) {
+
+        return;
+    }
+
+    try {
+
+        for (Run = 0; Run < Entry->RunCount; Run += 1) {
+
+            FatAddMcbEntry( Vcb,
+                            &Fcb->Mcb,
+                            Entry->Runs[Run].Vbo,
+                            Entry->Runs[Run].Lbo,
+                            Entry->Runs[Run].ByteCount );
+        }
+
+    } finally {
+
+        ExFreePool( Entry );
+    }
+}
+
+
+VOID
+FatPurgeExtentCache (
+    IN PVCB Vcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine empties the volume's extent cache.  It is called when the
+    FAT may change behind our back, e.g. when the volume is locked, and as
+    the volume goes away.
+
+Arguments:
+
+    Vcb - Supplies the volume
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PLIST_ENTRY Links;
+
+    PAGED_CODE();
+
+    ExAcquireFastMutex( &Vcb->ExtentCacheMutex );
+
+    while (!IsListEmpty( &Vcb->ExtentCacheList )) {
+
+        Links = RemoveHeadList( &Vcb->ExtentCacheList );
+
+        ExFreePool( CONTAINING_RECORD( Links, FAT_EXTENT_CACHE_ENTRY, Links ));
+    }
+
+    Vcb->ExtentCacheCount = 0;
+
+    ExReleaseFastMutex( &Vcb->ExtentCacheMutex );
+}
+
 
 _Requires_lock_held_(_Global_critical_region_)    
 VOID
@@ -2065,6 +2525,8 @@ Arguments:
         StartingCluster += Window->FirstCluster;
         StartingCluster -= 2;
 
+        FatReserveVolumeClusters( Vcb, StartingCluster, ClusterCount );
+
         NT_ASSERT( PreviousClear - ClusterCount == Window->ClustersFree );
 
         FatUnlockFreeClusterBitMap( Vcb );
@@ -2115,6 +2577,8 @@ Arguments:
                                           ClusterCount );
                 }
 
+                FatUnreserveVolumeClusters( Vcb, StartingCluster, ClusterCount );
+
                 Window->ClustersFree += ClusterCount;
                 Vcb->AllocationSupport.NumberOfFreeClusters += ClusterCount;
 
@@ -2140,6 +2604,7 @@ Arguments:
 
         ULONG ClustersFound = 0;
         ULONG ClustersRemaining = 0;
+        ULONG VolumeRunCluster = 0;
 
         BOOLEAN LockedBitMap = FALSE;
         BOOLEAN SelectNextContigWindow = FALSE;
@@ -2297,7 +2762,29 @@ Arguments:
                             }
                         }
 
-                        if (0 == ClustersFound)  {
+                        if ((0 == ClustersFound) &&
+                            (Vcb->VolumeClusterBitMap.Buffer != NULL) &&
+                            !ExactMatchRequired) {
+
+                            ULONG VolumeIndex;
+
+                            //
+                            //  This window can't hold the rest of the request in one run.
+                            //  Rather than splitting it up,  see if there is a free run big
+                            //  enough anywhere on the volume.  If so,  we'll move to the
+                            //  window it starts in and allocate from there with a hint,
+                            //  stepping through the following windows as need be.
+                            //
+
+                            VolumeIndex = RtlFindClearBits( &Vcb->VolumeClusterBitMap,  ClustersRemaining,  0);
+
+                            if (-1 != VolumeIndex)  {
+
+                                VolumeRunCluster = VolumeIndex + 2;
+                            }
+                        }
+
+                        if ((0 == ClustersFound) && (0 == VolumeRunCluster))  {
                             
                             //
                             //  Still nothing,  so just take the largest free run we can find.
@@ -2354,7 +2841,21 @@ Arguments:
 
                     SelectedWindow = FALSE;
 
-                    if ( SelectNextContigWindow)  {
+                    if (0 != VolumeRunCluster)  {
+
+                        //
+                        //  We found a big enough run in the volume bitmap.  Go to its
+                        //  window and hint at its start.
+                        //
+
+                        FaveWindow = FatWindowOfCluster( VolumeRunCluster );
+                        WindowRelativeHint = VolumeRunCluster - Vcb->Windows[ FaveWindow].FirstCluster + 2;
+                        SelectedWindow = TRUE;
+
+                        SelectNextContigWindow = FALSE;
+                        VolumeRunCluster = 0;
+                    }
+                    else if ( SelectNextContigWindow)  {
 
                         ULONG NextWindow;
 
@@ -2407,19 +2908,22 @@ Arguments:
                         FatBugCheck( 0, 5, 1 );
                     }
 
-                    Wait = BooleanFlagOn(IrpContext->Flags, IRP_CONTEXT_FLAG_WAIT);
-                    SetFlag(IrpContext->Flags, IRP_CONTEXT_FLAG_WAIT);
+                    if (&Vcb->Windows[FaveWindow] != Vcb->CurrentWindow) {
 
-                    FatExamineFatEntries( IrpContext, Vcb,
-                                          0,
-                                          0,
-                                          FALSE,
-                                          &Vcb->Windows[FaveWindow],
-                                          NULL);
+                        Wait = BooleanFlagOn(IrpContext->Flags, IRP_CONTEXT_FLAG_WAIT);
+                        SetFlag(IrpContext->Flags, IRP_CONTEXT_FLAG_WAIT);
 
-                    if (!Wait) {
+                        FatExamineFatEntries( IrpContext, Vcb,
+                                              0,
+                                              0,
+                                              FALSE,
+                                              &Vcb->Windows[FaveWindow],
+                                              NULL);
 
-                        ClearFlag(IrpContext->Flags, IRP_CONTEXT_FLAG_WAIT);
+                        if (!Wait) {
+
+                            ClearFlag(IrpContext->Flags, IRP_CONTEXT_FLAG_WAIT);
+                        }
                     }
 
                     //
@@ -2442,6 +2946,8 @@ Arguments:
                     FatReserveClusters( IrpContext, Vcb, (Index + 2), ClustersFound );
 
                     Cluster = Index + Window->FirstCluster;
+
+                    FatReserveVolumeClusters( Vcb, Cluster, ClustersFound );
                     
                     Window->ClustersFree -= ClustersFound;
                     NT_ASSERT( PreviousClear - ClustersFound == Window->ClustersFree );
@@ -2540,6 +3046,8 @@ Arguments:
                                               ClustersFound );
                     }
 
+                    FatUnreserveVolumeClusters( Vcb, Cluster, ClustersFound );
+
                     //
                     //  Note that FatDeallocateDiskSpace will take care of adjusting
                     //  to account for the entries in the Mcb.  All we have to account
@@ -2886,6 +3394,8 @@ Return Value:
 
             ClusterIndex = FatGetIndexFromLbo( Vcb, Lbo );
 
+            FatUnreserveVolumeClusters( Vcb, ClusterIndex, ClusterCount );
+
             Window = Vcb->CurrentWindow;
 
             //
@@ -4786,9 +5296,19 @@ Return Value:
         //  It is fine to monkey with the real windows, we must be able
         //  to do this to activate the volume.
         //
+        //  If we have a volume cluster bitmap, fill it in on the way past.
+        //
 
         BitMap = NULL;
 
+        if (Vcb->VolumeClusterBitMap.Buffer != NULL) {
+
+            NT_ASSERT( StartIndex == 2 );
+            NT_ASSERT( EndIndex - StartIndex + 1 == Vcb->VolumeClusterBitMap.SizeOfBitMap );
+
+            BitMap = &Vcb->VolumeClusterBitMap;
+        }
+
         CurrentWindow = &Vcb->Windows[0];
         CurrentWindow->FirstCluster = StartIndex;
         CurrentWindow->ClustersFree = 0;
@@ -4856,6 +5376,39 @@ Return Value:
 
     NT_ASSERT( StartIndex >= 2 );
 
+    //
+    //  If we are switching FAT32 windows and have a volume cluster bitmap,
+    //  the window bitmap is just a slice of it and we need not read the FAT.
+    //  Windows start on a MAX_CLUSTER_BITMAP_SIZE boundary, so the slice is
+    //  byte aligned.
+    //
+
+    if ((NewBitMapBuffer != NULL) &&
+        (Vcb->VolumeClusterBitMap.Buffer != NULL)) {
+
+        NT_ASSERT( ((StartIndex - 2) % 8) == 0 );
+
+        RtlCopyMemory( NewBitMapBuffer,
+                       (PUCHAR)Vcb->VolumeClusterBitMap.Buffer + (StartIndex - 2) / 8,
+                       (EndIndex - StartIndex + 1 + 7) / 8 );
+
+        if (Vcb->FreeClusterBitMap.Buffer) {
+
+            ExFreePool( Vcb->FreeClusterBitMap.Buffer );
+        }
+
+        RtlInitializeBitMap( &Vcb->FreeClusterBitMap,
+                             NewBitMapBuffer,
+                             EndIndex - StartIndex + 1 );
+
+        Vcb->CurrentWindow = SwitchToWindow;
+        Vcb->ClusterHint = (ULONG)-1;
+
+        ASSERT_CURRENT_WINDOW_GOOD( Vcb );
+
+        return;
+    }
+
     try {
 
         //
@@ -4977,10 +5530,23 @@ Return Value:
                             *FreeClusterCount += ClustersThisRun;
                         }
 
+                        if (BitMap) {
+
+                            RtlClearBits( BitMap,
+                                          StartIndexOfThisRun - StartIndex,
+                                          ClustersThisRun );
+                        }
+
                     } else {
 
                         NT_ASSERT(CurrentRun == AllocatedClusters);
 
+                        if (BitMap) {
+
+                            RtlSetBits( BitMap,
+                                        StartIndexOfThisRun - StartIndex,
+                                        FatIndex - StartIndexOfThisRun );
+                        }
                     }
 
                     StartIndexOfThisRun = FatIndex;
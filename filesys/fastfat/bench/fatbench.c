@@ -0,0 +1,980 @@
+/*++
+
+Copyright (c) 1989-2002  Microsoft Corporation
+
+Module Name:
+
+    fatbench.c
+
+Abstract:
+
+    This file contains a user mode benchmark for the fastfat sample.  It
+    runs metadata and data workloads against a directory on a FAT volume,
+    typically a VHD mounted for the purpose, and writes one CSV line per
+    workload with the operation rate and latency percentiles.
+
+    The workloads are
+
+        create      - create and close new files
+        open        - open existing files by name in random order
+        enum        - enumerate the directory
+        rename      - rename every file in place
+        delete      - delete every file
+        seqread     - non-cached sequential read of a contiguous file
+        fragread    - non-cached sequential read of a fragmented file
+        fatgrow     - extend a file one cluster sized chunk at a time
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_code_)
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <windows.h>
+#include <strsafe.h>
+
+#define SUCCESS              0
+#define USAGE_ERROR          1
+#define WORKLOAD_ERROR       2
+
+#define DEFAULT_FILE_COUNT   10000
+#define DEFAULT_FILE_SIZE    (64 * 1024 * 1024)
+#define DEFAULT_IO_SIZE      (64 * 1024)
+#define DEFAULT_GROW_SIZE    (4 * 1024)
+
+#define BENCH_DIR_NAME       L"fatbench.tmp"
+#define BENCH_SEQ_FILE       L"seq.dat"
+#define BENCH_FRAG_FILE      L"frag.dat"
+#define BENCH_FRAG_FILLER    L"filler.dat"
+#define BENCH_GROW_FILE      L"grow.dat"
+
+//
+//  Settings for a run, taken from the command line.
+//
+
+typedef struct _BENCH_CONTEXT {
+
+    WCHAR Directory[MAX_PATH];
+
+    ULONG FileCount;
+    ULONG FileSize;
+    ULONG IoSize;
+    ULONG GrowSize;
+
+    //
+    //  Latency samples for the current workload, in performance counter
+    //  ticks.
+    //
+
+    PULONGLONG Samples;
+    ULONG SampleCount;
+    ULONG SampleMax;
+
+    LARGE_INTEGER Frequency;
+
+    PVOID IoBuffer;
+
+} BENCH_CONTEXT, *PBENCH_CONTEXT;
+
+typedef
+DWORD
+(*PBENCH_WORKLOAD) (
+    _Inout_ PBENCH_CONTEXT Context,
+    _Out_ PULONGLONG Bytes
+    );
+
+typedef struct _BENCH_WORKLOAD_ENTRY {
+
+    PCWSTR Name;
+    PBENCH_WORKLOAD Routine;
+
+} BENCH_WORKLOAD_ENTRY;
+
+DWORD BenchCreate( _Inout_ PBENCH_CONTEXT Context, _Out_ PULONGLONG Bytes );
+DWORD BenchOpen( _Inout_ PBENCH_CONTEXT Context, _Out_ PULONGLONG Bytes );
+DWORD BenchEnumerate( _Inout_ PBENCH_CONTEXT Context, _Out_ PULONGLONG Bytes );
+DWORD BenchRename( _Inout_ PBENCH_CONTEXT Context, _Out_ PULONGLONG Bytes );
+DWORD BenchDelete( _Inout_ PBENCH_CONTEXT Context, _Out_ PULONGLONG Bytes );
+DWORD BenchSequentialRead( _Inout_ PBENCH_CONTEXT Context, _Out_ PULONGLONG Bytes );
+DWORD BenchFragmentedRead( _Inout_ PBENCH_CONTEXT Context, _Out_ PULONGLONG Bytes );
+DWORD BenchFatGrowth( _Inout_ PBENCH_CONTEXT Context, _Out_ PULONGLONG Bytes );
+
+//
+//  The metadata workloads depend on running in this order: open, enum and
+//  rename use the files from create, and delete removes the renamed files.
+//
+
+const BENCH_WORKLOAD_ENTRY Workloads[] = {
+    { L"create",   BenchCreate },
+    { L"open",     BenchOpen },
+    { L"enum",     BenchEnumerate },
+    { L"rename",   BenchRename },
+    { L"delete",   BenchDelete },
+    { L"seqread",  BenchSequentialRead },
+    { L"fragread", BenchFragmentedRead },
+    { L"fatgrow",  BenchFatGrowth },
+};
+
+#define WORKLOAD_COUNT  (sizeof( Workloads ) / sizeof( Workloads[0] ))
+
+
+VOID
+Usage (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    Prints usage
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+
+{
+    wprintf( L"Usage: fatbench <directory> [-n files] [-s filesize] [-i iosize] [-g growsize] [workload ...]\n"
+             L"    directory - directory on the FAT volume to run in\n"
+             L"    -n        - number of files for the metadata workloads (default %u)\n"
+             L"    -s        - size in bytes of the read and growth files (default %u)\n"
+             L"    -i        - size in bytes of each read (default %u)\n"
+             L"    -g        - size in bytes of each extension in fatgrow (default %u)\n"
+             L"    workload  - any of create open enum rename delete seqread fragread fatgrow\n"
+             L"                (default all, in that order)\n",
+             DEFAULT_FILE_COUNT,
+             DEFAULT_FILE_SIZE,
+             DEFAULT_IO_SIZE,
+             DEFAULT_GROW_SIZE );
+}
+
+
+VOID
+StartSample (
+    _Out_ PLARGE_INTEGER Start
+    )
+{
+    QueryPerformanceCounter( Start );
+}
+
+
+VOID
+EndSample (
+    _Inout_ PBENCH_CONTEXT Context,
+    _In_ PLARGE_INTEGER Start
+    )
+
+/*++
+
+Routine Description:
+
+    Records the latency of one operation which began at Start.  Samples
+    past the space we allocated are dropped.
+
+Arguments:
+
+    Context - The benchmark context.
+
+    Start - Counter value when the operation began.
+
+Return Value:
+
+    None
+
+--*/
+
+{
+    LARGE_INTEGER End;
+
+    QueryPerformanceCounter( &End );
+
+    if (Context->SampleCount < Context->SampleMax) {
+
+        Context->Samples[Context->SampleCount++] = (ULONGLONG)(End.QuadPart - Start->QuadPart);
+    }
+}
+
+
+int
+__cdecl
+CompareSamples (
+    _In_ const void *First,
+    _In_ const void *Second
+    )
+{
+    ULONGLONG A = *(const ULONGLONG *)First;
+    ULONGLONG B = *(const ULONGLONG *)Second;
+
+    return (A < B) ? -1 : ((A > B) ? 1 : 0);
+}
+
+
+ULONGLONG
+Percentile (
+    _In_ PBENCH_CONTEXT Context,
+    _In_ ULONG Percent
+    )
+
+/*++
+
+Routine Description:
+
+    Returns the given percentile of the sorted samples in microseconds.
+
+--*/
+
+{
+    ULONG Index;
+
+    if (Context->SampleCount == 0) {
+
+        return 0;
+    }
+
+    Index = (ULONG)(((ULONGLONG)(Context->SampleCount - 1) * Percent) / 100);
+
+    return (Context->Samples[Index] * 1000000) / Context->Frequency.QuadPart;
+}
+
+
+VOID
+BuildPath (
+    _In_ PBENCH_CONTEXT Context,
+    _In_ PCWSTR Name,
+    _Out_writes_(MAX_PATH) PWCHAR Path
+    )
+{
+    StringCchPrintfW( Path, MAX_PATH, L"%s\\%s", Context->Directory, Name );
+}
+
+
+VOID
+BuildNumberedPath (
+    _In_ PBENCH_CONTEXT Context,
+    _In_ PCWSTR Prefix,
+    _In_ ULONG Number,
+    _Out_writes_(MAX_PATH) PWCHAR Path
+    )
+
+/*++
+
+Routine Description:
+
+    Builds the name of one of the metadata workload files.  The names are
+    long names so that every file has an LFN dirent set as well as a short
+    name.
+
+--*/
+
+{
+    StringCchPrintfW( Path,
+                      MAX_PATH,
+                      L"%s\\%s file number %08u.txt",
+                      Context->Directory,
+                      Prefix,
+                      Number );
+}
+
+
+DWORD
+BenchCreate (
+    _Inout_ PBENCH_CONTEXT Context,
+    _Out_ PULONGLONG Bytes
+    )
+{
+    WCHAR Path[MAX_PATH];
+    LARGE_INTEGER Start;
+    HANDLE File;
+    ULONG Index;
+
+    *Bytes = 0;
+
+    for (Index = 0; Index < Context->FileCount; Index += 1) {
+
+        BuildNumberedPath( Context, L"bench", Index, Path );
+
+        StartSample( &Start );
+
+        File = CreateFileW( Path,
+                            GENERIC_READ | GENERIC_WRITE,
+                            0,
+                            NULL,
+                            CREATE_NEW,
+                            FILE_ATTRIBUTE_NORMAL,
+                            NULL );
+
+        if (File == INVALID_HANDLE_VALUE) {
+
+            return GetLastError();
+        }
+
+        CloseHandle( File );
+
+        EndSample( Context, &Start );
+    }
+
+    return ERROR_SUCCESS;
+}
+
+
+DWORD
+BenchOpen (
+    _Inout_ PBENCH_CONTEXT Context,
+    _Out_ PULONGLONG Bytes
+    )
+{
+    WCHAR Path[MAX_PATH];
+    LARGE_INTEGER Start;
+    HANDLE File;
+    ULONG Index;
+    ULONG Number;
+
+    *Bytes = 0;
+
+    srand( 0 );
+
+    for (Index = 0; Index < Context->FileCount; Index += 1) {
+
+        Number = (ULONG)(((ULONGLONG)rand() * RAND_MAX + rand()) % Context->FileCount);
+
+        BuildNumberedPath( Context, L"bench", Number, Path );
+
+        StartSample( &Start );
+
+        File = CreateFileW( Path,
+                            FILE_READ_ATTRIBUTES,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                            NULL,
+                            OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL,
+                            NULL );
+
+        if (File == INVALID_HANDLE_VALUE) {
+
+            return GetLastError();
+        }
+
+        CloseHandle( File );
+
+        EndSample( Context, &Start );
+    }
+
+    return ERROR_SUCCESS;
+}
+
+
+DWORD
+BenchEnumerate (
+    _Inout_ PBENCH_CONTEXT Context,
+    _Out_ PULONGLONG Bytes
+    )
+
+/*++
+
+Routine Description:
+
+    Enumerates the whole directory a number of times.  Each sample is one
+    FindNextFile call.
+
+--*/
+
+{
+    WCHAR Path[MAX_PATH];
+    WIN32_FIND_DATAW FindData;
+    LARGE_INTEGER Start;
+    HANDLE Find;
+    ULONG Pass;
+
+    *Bytes = 0;
+
+    BuildPath( Context, L"*", Path );
+
+    for (Pass = 0; Pass < 10; Pass += 1) {
+
+        Find = FindFirstFileExW( Path,
+                                 FindExInfoBasic,
+                                 &FindData,
+                                 FindExSearchNameMatch,
+                                 NULL,
+                                 FIND_FIRST_EX_LARGE_FETCH );
+
+        if (Find == INVALID_HANDLE_VALUE) {
+
+            return GetLastError();
+        }
+
+        for (;;) {
+
+            StartSample( &Start );
+
+            if (!FindNextFileW( Find, &FindData )) {
+
+                break;
+            }
+
+            EndSample( Context, &Start );
+        }
+
+        FindClose( Find );
+    }
+
+    return ERROR_SUCCESS;
+}
+
+
+DWORD
+BenchRename (
+    _Inout_ PBENCH_CONTEXT Context,
+    _Out_ PULONGLONG Bytes
+    )
+{
+    WCHAR Path[MAX_PATH];
+    WCHAR NewPath[MAX_PATH];
+    LARGE_INTEGER Start;
+    ULONG Index;
+
+    *Bytes = 0;
+
+    for (Index = 0; Index < Context->FileCount; Index += 1) {
+
+        BuildNumberedPath( Context, L"bench", Index, Path );
+        BuildNumberedPath( Context, L"renamed", Index, NewPath );
+
+        StartSample( &Start );
+
+        if (!MoveFileExW( Path, NewPath, 0 )) {
+
+            return GetLastError();
+        }
+
+        EndSample( Context, &Start );
+    }
+
+    return ERROR_SUCCESS;
+}
+
+
+DWORD
+BenchDelete (
+    _Inout_ PBENCH_CONTEXT Context,
+    _Out_ PULONGLONG Bytes
+    )
+{
+    WCHAR Path[MAX_PATH];
+    LARGE_INTEGER Start;
+    ULONG Index;
+
+    *Bytes = 0;
+
+    for (Index = 0; Index < Context->FileCount; Index += 1) {
+
+        BuildNumberedPath( Context, L"renamed", Index, Path );
+
+        StartSample( &Start );
+
+        if (!DeleteFileW( Path )) {
+
+            return GetLastError();
+        }
+
+        EndSample( Context, &Start );
+    }
+
+    return ERROR_SUCCESS;
+}
+
+
+DWORD
+WriteFileOfSize (
+    _In_ PBENCH_CONTEXT Context,
+    _In_ HANDLE File,
+    _In_ ULONG Size
+    )
+
+/*++
+
+Routine Description:
+
+    Appends Size bytes to the file in IoSize chunks.  This is setup work
+    and is not sampled.
+
+--*/
+
+{
+    ULONG Written = 0;
+    DWORD Transferred;
+
+    while (Written < Size) {
+
+        if (!WriteFile( File, Context->IoBuffer, Context->IoSize, &Transferred, NULL )) {
+
+            return GetLastError();
+        }
+
+        Written += Transferred;
+    }
+
+    return ERROR_SUCCESS;
+}
+
+
+DWORD
+ReadFileNonCached (
+    _Inout_ PBENCH_CONTEXT Context,
+    _In_ PCWSTR Path,
+    _Out_ PULONGLONG Bytes
+    )
+
+/*++
+
+Routine Description:
+
+    Reads the file from start to end with non-cached IoSize reads, taking
+    one sample per read.
+
+--*/
+
+{
+    LARGE_INTEGER Start;
+    HANDLE File;
+    DWORD Transferred;
+
+    *Bytes = 0;
+
+    File = CreateFileW( Path,
+                        GENERIC_READ,
+                        FILE_SHARE_READ,
+                        NULL,
+                        OPEN_EXISTING,
+                        FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN,
+                        NULL );
+
+    if (File == INVALID_HANDLE_VALUE) {
+
+        return GetLastError();
+    }
+
+    for (;;) {
+
+        StartSample( &Start );
+
+        if (!ReadFile( File, Context->IoBuffer, Context->IoSize, &Transferred, NULL ) ||
+            (Transferred == 0)) {
+
+            break;
+        }
+
+        EndSample( Context, &Start );
+
+        *Bytes += Transferred;
+    }
+
+    CloseHandle( File );
+
+    return ERROR_SUCCESS;
+}
+
+
+DWORD
+BenchSequentialRead (
+    _Inout_ PBENCH_CONTEXT Context,
+    _Out_ PULONGLONG Bytes
+    )
+{
+    WCHAR Path[MAX_PATH];
+    HANDLE File;
+    LARGE_INTEGER Size;
+    DWORD Status;
+
+    BuildPath( Context, BENCH_SEQ_FILE, Path );
+
+    //
+    //  Set the size up front so the file is allocated in one piece.
+    //
+
+    File = CreateFileW( Path,
+                        GENERIC_READ | GENERIC_WRITE,
+                        0,
+                        NULL,
+                        CREATE_ALWAYS,
+                        FILE_ATTRIBUTE_NORMAL,
+                        NULL );
+
+    if (File == INVALID_HANDLE_VALUE) {
+
+        return GetLastError();
+    }
+
+    Size.QuadPart = Context->FileSize;
+
+    if (!SetFilePointerEx( File, Size, NULL, FILE_BEGIN ) ||
+        !SetEndOfFile( File )) {
+
+        Status = GetLastError();
+        CloseHandle( File );
+        return Status;
+    }
+
+    Size.QuadPart = 0;
+    SetFilePointerEx( File, Size, NULL, FILE_BEGIN );
+
+    Status = WriteFileOfSize( Context, File, Context->FileSize );
+    CloseHandle( File );
+
+    if (Status == ERROR_SUCCESS) {
+
+        Status = ReadFileNonCached( Context, Path, Bytes );
+    }
+
+    DeleteFileW( Path );
+    return Status;
+}
+
+
+DWORD
+BenchFragmentedRead (
+    _Inout_ PBENCH_CONTEXT Context,
+    _Out_ PULONGLONG Bytes
+    )
+
+/*++
+
+Routine Description:
+
+    Builds a fragmented file by alternating flushed appends to it and to a
+    filler file, so their clusters interleave on the volume, then reads it
+    non-cached.
+
+--*/
+
+{
+    WCHAR Path[MAX_PATH];
+    WCHAR FillerPath[MAX_PATH];
+    HANDLE File;
+    HANDLE Filler;
+    ULONG Written;
+    DWORD Transferred;
+    DWORD Status = ERROR_SUCCESS;
+
+    BuildPath( Context, BENCH_FRAG_FILE, Path );
+    BuildPath( Context, BENCH_FRAG_FILLER, FillerPath );
+
+    File = CreateFileW( Path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_WRITE_THROUGH, NULL );
+    Filler = CreateFileW( FillerPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_WRITE_THROUGH, NULL );
+
+    if ((File == INVALID_HANDLE_VALUE) || (Filler == INVALID_HANDLE_VALUE)) {
+
+        Status = GetLastError();
+    }
+
+    for (Written = 0;
+         (Status == ERROR_SUCCESS) && (Written < Context->FileSize);
+         Written += Context->GrowSize) {
+
+        if (!WriteFile( File, Context->IoBuffer, Context->GrowSize, &Transferred, NULL ) ||
+            !WriteFile( Filler, Context->IoBuffer, Context->GrowSize, &Transferred, NULL )) {
+
+            Status = GetLastError();
+        }
+    }
+
+    if (File != INVALID_HANDLE_VALUE) {
+
+        CloseHandle( File );
+    }
+
+    if (Filler != INVALID_HANDLE_VALUE) {
+
+        CloseHandle( Filler );
+    }
+
+    if (Status == ERROR_SUCCESS) {
+
+        Status = ReadFileNonCached( Context, Path, Bytes );
+    }
+
+    DeleteFileW( Path );
+    DeleteFileW( FillerPath );
+    return Status;
+}
+
+
+DWORD
+BenchFatGrowth (
+    _Inout_ PBENCH_CONTEXT Context,
+    _Out_ PULONGLONG Bytes
+    )
+
+/*++
+
+Routine Description:
+
+    Extends a file by GrowSize at a time with write through, so that each
+    sample includes allocating clusters and writing the FAT.
+
+--*/
+
+{
+    WCHAR Path[MAX_PATH];
+    LARGE_INTEGER Start;
+    HANDLE File;
+    ULONG Written;
+    DWORD Transferred;
+    DWORD Status = ERROR_SUCCESS;
+
+    *Bytes = 0;
+
+    BuildPath( Context, BENCH_GROW_FILE, Path );
+
+    File = CreateFileW( Path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_WRITE_THROUGH, NULL );
+
+    if (File == INVALID_HANDLE_VALUE) {
+
+        return GetLastError();
+    }
+
+    for (Written = 0; Written < Context->FileSize; Written += Context->GrowSize) {
+
+        StartSample( &Start );
+
+        if (!WriteFile( File, Context->IoBuffer, Context->GrowSize, &Transferred, NULL )) {
+
+            Status = GetLastError();
+            break;
+        }
+
+        EndSample( Context, &Start );
+
+        *Bytes += Transferred;
+    }
+
+    CloseHandle( File );
+    DeleteFileW( Path );
+    return Status;
+}
+
+
+DWORD
+RunWorkload (
+    _Inout_ PBENCH_CONTEXT Context,
+    _In_ const BENCH_WORKLOAD_ENTRY *Workload
+    )
+
+/*++
+
+Routine Description:
+
+    Runs one workload and prints its CSV line.
+
+Arguments:
+
+    Context - The benchmark context.
+
+    Workload - The workload to run.
+
+Return Value:
+
+    Win32 error code from the workload.
+
+--*/
+
+{
+    LARGE_INTEGER Start;
+    LARGE_INTEGER End;
+    ULONGLONG Bytes = 0;
+    double Seconds;
+    DWORD Status;
+
+    Context->SampleCount = 0;
+
+    QueryPerformanceCounter( &Start );
+    Status = Workload->Routine( Context, &Bytes );
+    QueryPerformanceCounter( &End );
+
+    if (Status != ERROR_SUCCESS) {
+
+        fwprintf( stderr, L"fatbench: %s failed with error %u\n", Workload->Name, Status );
+        return Status;
+    }
+
+    Seconds = (double)(End.QuadPart - Start.QuadPart) / (double)Context->Frequency.QuadPart;
+
+    qsort( Context->Samples, Context->SampleCount, sizeof( ULONGLONG ), CompareSamples );
+
+    wprintf( L"%s,%u,%.3f,%.1f,%.1f,%I64u,%I64u,%I64u,%I64u,%I64u\n",
+             Workload->Name,
+             Context->SampleCount,
+             Seconds,
+             (Seconds > 0) ? (Context->SampleCount / Seconds) : 0.0,
+             (Seconds > 0) ? ((double)Bytes / (1024 * 1024) / Seconds) : 0.0,
+             Percentile( Context, 50 ),
+             Percentile( Context, 90 ),
+             Percentile( Context, 99 ),
+             Percentile( Context, 100 ),
+             Bytes );
+
+    return ERROR_SUCCESS;
+}
+
+
+int
+_cdecl
+wmain (
+    _In_ int argc,
+    _In_reads_(argc) WCHAR *argv[]
+    )
+{
+    BENCH_CONTEXT Context;
+    BOOLEAN Selected[WORKLOAD_COUNT];
+    BOOLEAN AnySelected = FALSE;
+    DWORD Status = ERROR_SUCCESS;
+    int ArgIndex;
+    ULONG Index;
+
+    ZeroMemory( &Context, sizeof( Context ));
+    ZeroMemory( Selected, sizeof( Selected ));
+
+    Context.FileCount = DEFAULT_FILE_COUNT;
+    Context.FileSize = DEFAULT_FILE_SIZE;
+    Context.IoSize = DEFAULT_IO_SIZE;
+    Context.GrowSize = DEFAULT_GROW_SIZE;
+
+    if (argc < 2) {
+
+        Usage();
+        return USAGE_ERROR;
+    }
+
+    for (ArgIndex = 2; ArgIndex < argc; ArgIndex += 1) {
+
+        if ((argv[ArgIndex][0] == L'-') && (ArgIndex + 1 < argc)) {
+
+            ULONG Value = wcstoul( argv[ArgIndex + 1], NULL, 0 );
+
+            switch (argv[ArgIndex][1]) {
+
+            case L'n': Context.FileCount = Value; break;
+            case L's': Context.FileSize = Value; break;
+            case L'i': Context.IoSize = Value; break;
+            case L'g': Context.GrowSize = Value; break;
+
+            default:
+                Usage();
+                return USAGE_ERROR;
+            }
+
+            ArgIndex += 1;
+            continue;
+        }
+
+        for (Index = 0; Index < WORKLOAD_COUNT; Index += 1) {
+
+            if (_wcsicmp( argv[ArgIndex], Workloads[Index].Name ) == 0) {
+
+                Selected[Index] = TRUE;
+                AnySelected = TRUE;
+                break;
+            }
+        }
+
+        if (Index == WORKLOAD_COUNT) {
+
+            Usage();
+            return USAGE_ERROR;
+        }
+    }
+
+    //
+    //  Non-cached reads need sector aligned sizes.  4K covers every sector
+    //  size we expect to see.
+    //
+
+    if ((Context.FileCount == 0) ||
+        (Context.IoSize == 0) || ((Context.IoSize % 4096) != 0) ||
+        (Context.GrowSize == 0) || (Context.GrowSize > Context.IoSize) ||
+        (Context.FileSize < Context.IoSize)) {
+
+        Usage();
+        return USAGE_ERROR;
+    }
+
+    //
+    //  Work in a private subdirectory so the metadata workloads see only
+    //  their own files.
+    //
+
+    StringCchPrintfW( Context.Directory, MAX_PATH, L"%s\\%s", argv[1], BENCH_DIR_NAME );
+
+    if (!CreateDirectoryW( Context.Directory, NULL ) &&
+        (GetLastError() != ERROR_ALREADY_EXISTS)) {
+
+        fwprintf( stderr, L"fatbench: can't create %s, error %u\n", Context.Directory, GetLastError() );
+        return WORKLOAD_ERROR;
+    }
+
+    QueryPerformanceFrequency( &Context.Frequency );
+
+    //
+    //  Enumeration takes the most samples of the metadata workloads, ten
+    //  passes over the directory.
+    //
+
+    Context.SampleMax = max( Context.FileCount * 10, Context.FileSize / Context.GrowSize ) + 16;
+    Context.Samples = malloc( (SIZE_T)Context.SampleMax * sizeof( ULONGLONG ));
+
+    //
+    //  VirtualAlloc gives us the page alignment non-cached Io requires.
+    //
+
+    Context.IoBuffer = VirtualAlloc( NULL, Context.IoSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE );
+
+    if ((Context.Samples == NULL) || (Context.IoBuffer == NULL)) {
+
+        fwprintf( stderr, L"fatbench: out of memory\n" );
+        Status = ERROR_NOT_ENOUGH_MEMORY;
+        goto Cleanup;
+    }
+
+    FillMemory( Context.IoBuffer, Context.IoSize, 0xA5 );
+
+    wprintf( L"workload,ops,seconds,ops_per_sec,mb_per_sec,p50_us,p90_us,p99_us,max_us,bytes\n" );
+
+    for (Index = 0; Index < WORKLOAD_COUNT; Index += 1) {
+
+        if (AnySelected && !Selected[Index]) {
+
+            continue;
+        }
+
+        Status = RunWorkload( &Context, &Workloads[Index] );
+
+        if (Status != ERROR_SUCCESS) {
+
+            break;
+        }
+    }
+
+Cleanup:
+
+    if (Context.IoBuffer != NULL) {
+
+        VirtualFree( Context.IoBuffer, 0, MEM_RELEASE );
+    }
+
+    free( Context.Samples );
+
+    RemoveDirectoryW( Context.Directory );
+
+    return (Status == ERROR_SUCCESS) ? SUCCESS : WORKLOAD_ERROR;
+}
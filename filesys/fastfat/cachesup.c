@@ -28,6 +28,13 @@ Abstract:
 
 #define Dbg                              (DEBUG_TRACE_CACHESUP)
 
+//
+//  Define the most a directory is read ahead when it is first read.  This
+//  covers 16,384 dirents, which is more than most directories ever hold.
+//
+
+#define FAT_DIRECTORY_PREFETCH_PAGE_COUNT    0x80
+
 #if DBG
 
 BOOLEAN
@@ -38,9 +45,17 @@ FatIsCurrentOperationSynchedForDcbTeardown (
 
 #endif
 
+ULONG
+FatCountRepinnedBcbsInFile (
+    IN PREPINNED_BCBS Repinned,
+    IN ULONG Index,
+    IN PFILE_OBJECT FileObject
+    );
+
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE, FatCloseEaFile)
 #pragma alloc_text(PAGE, FatCompleteMdl)
+#pragma alloc_text(PAGE, FatCountRepinnedBcbsInFile)
 #pragma alloc_text(PAGE, FatOpenDirectoryFile)
 #pragma alloc_text(PAGE, FatOpenEaFile)
 #pragma alloc_text(PAGE, FatPinMappedData)
@@ -404,6 +419,49 @@ Arguments:
 
     NT_ASSERT( ByteCount != 0 );
 
+#if (NTDDI_VERSION >= NTDDI_WIN8)
+
+    //
+    //  The first read of a cold directory, whether for an enumeration or a
+    //  lookup, is usually followed by reads of the rest of it, one page
+    //  at a time.  Rather than take one synchronous read per page, read
+    //  ahead from here to the end of the allocation, up to a cap, in a
+    //  single prefetch.  The Mcb of the directory was loaded when its
+    //  allocation size was looked up, so Mm can issue the reads for all
+    //  of the runs in parallel and we only wait for the slowest of them.
+    //
+
+    if (FlagOn( IrpContext->Flags, IRP_CONTEXT_FLAG_WAIT ) &&
+        (IrpContext->OriginatingIrp != NULL) &&
+        (Dcb->Specific.Dcb.DirectoryPrefetched == FALSE) &&
+        (InterlockedExchange( &Dcb->Specific.Dcb.DirectoryPrefetched, TRUE ) == FALSE)) {
+
+        ULONG StartingPage = StartingVbo / PAGE_SIZE;
+        ULONG EndPage = (ULONG)(ROUND_TO_PAGES( Dcb->Header.AllocationSize.LowPart ) / PAGE_SIZE);
+
+        if (EndPage - StartingPage > FAT_DIRECTORY_PREFETCH_PAGE_COUNT) {
+
+            EndPage = StartingPage + FAT_DIRECTORY_PREFETCH_PAGE_COUNT;
+        }
+
+        //
+        //  A directory that fits in the page we are about to map gains
+        //  nothing from this.  Failure to prefetch is not an error; the
+        //  pages are simply read as they are mapped.
+        //
+
+        if (EndPage - StartingPage > 1) {
+
+            DebugTrace( 0, Dbg, "Prefetching %08lx directory pages\n", EndPage - StartingPage);
+
+            (VOID)FatPrefetchPages( IrpContext,
+                                    Dcb->Specific.Dcb.DirectoryFile,
+                                    StartingPage,
+                                    EndPage - StartingPage );
+        }
+    }
+#endif
+
     //
     //  Call the Cache manager to attempt the transfer.
     //
@@ -960,6 +1018,13 @@ Return Value:
         Dcb->Header.ValidDataLength = FatMaxLarge;
         Dcb->ValidDataToDisk = MAXULONG;
 
+        //
+        //  The pages may have been purged along with the old cache map, so
+        //  let the next read prefetch the directory again.
+        //
+
+        InterlockedExchange( &Dcb->Specific.Dcb.DirectoryPrefetched, FALSE );
+
         FatInitializeCacheMap( Dcb->Specific.Dcb.DirectoryFile,
                                (PCC_FILE_SIZES)&Dcb->Header.AllocationSize,
                                TRUE,
@@ -1430,6 +1495,7 @@ Return Value:
     BOOLEAN ForceVerify = FALSE;
     ULONG i;
     PFCB FcbOrDcb = NULL;
+    ULONG FatBcbsToBatch = 0;
 
     PAGED_CODE();
     
@@ -1502,9 +1568,54 @@ Return Value:
                     FileObject = CcGetFileObjectFromBcb( Repinned->Bcb[i] );
                 }
 
-                CcUnpinRepinnedBcb( Repinned->Bcb[i],
-                                    WriteThroughToDisk,
-                                    &Iosb );
+                //
+                //  Writing the FAT through a page at a time costs an I/O per
+                //  page for each copy of the FAT, which is painful when a large
+                //  extend touches a lot of FAT on slow removable media.  When
+                //  several FAT bcbs come in a row, unpin them without writing
+                //  and then flush the volume file once, so the write path can
+                //  gather the dirty runs and write all the FATs in parallel.
+                //  Bcbs of other files are still written in their original
+                //  order relative to the FAT.
+                //
+
+                if (WriteThroughToDisk && (FatBcbsToBatch == 0) &&
+                    (CcGetFileObjectFromBcb( Repinned->Bcb[i] ) == IrpContext->Vcb->VirtualVolumeFile)) {
+
+                    FatBcbsToBatch = FatCountRepinnedBcbsInFile( Repinned,
+                                                                 i,
+                                                                 IrpContext->Vcb->VirtualVolumeFile );
+
+                    if (FatBcbsToBatch < 2) {
+
+                        FatBcbsToBatch = 0;
+                    }
+                }
+
+                if (FatBcbsToBatch != 0) {
+
+                    CcUnpinRepinnedBcb( Repinned->Bcb[i],
+                                        FALSE,
+                                        &Iosb );
+
+                    Iosb.Status = STATUS_SUCCESS;
+
+                    FatBcbsToBatch -= 1;
+
+                    if (FatBcbsToBatch == 0) {
+
+                        CcFlushCache( &IrpContext->Vcb->SectionObjectPointers,
+                                      NULL,
+                                      0,
+                                      &Iosb );
+                    }
+
+                } else {
+
+                    CcUnpinRepinnedBcb( Repinned->Bcb[i],
+                                        WriteThroughToDisk,
+                                        &Iosb );
+                }
 
                 if (!NT_SUCCESS(Iosb.Status)) {
 
@@ -1653,6 +1764,68 @@ Return Value:
     return;
 }
 
+
+//
+//  Internal support routine
+//
+
+ULONG
+FatCountRepinnedBcbsInFile (
+    IN PREPINNED_BCBS Repinned,
+    IN ULONG Index,
+    IN PFILE_OBJECT FileObject
+    )
+
+/*++
+
+Routine Description:
+
+    This routine counts how many repinned bcbs, starting with the one at
+    the given position, in a row belong to the given file.
+
+Arguments:
+
+    Repinned - Supplies the repinned record holding the first bcb.
+
+    Index - Supplies the position of the first bcb within Repinned.
+
+    FileObject - Supplies the file the bcbs must belong to.
+
+Return Value:
+
+    ULONG - The length of the run.
+
+--*/
+
+{
+    ULONG Count = 0;
+
+    PAGED_CODE();
+
+    while (Repinned != NULL) {
+
+        for (; Index < REPINNED_BCBS_ARRAY_SIZE; Index += 1) {
+
+            if (Repinned->Bcb[Index] == NULL) {
+
+                continue;
+            }
+
+            if (CcGetFileObjectFromBcb( Repinned->Bcb[Index] ) != FileObject) {
+
+                return Count;
+            }
+
+            Count += 1;
+        }
+
+        Repinned = Repinned->Next;
+        Index = 0;
+    }
+
+    return Count;
+}
+
 
 FINISHED
 FatZeroData (
@@ -2249,6 +2249,13 @@ Return Value:
             Vcb->FileObjectWithVcbLocked = FileObject;
             UnwindVolumeLock = TRUE;
 
+            //
+            //  The volume may now be written directly, so forget the
+            //  allocation of closed files.
+            //
+
+            FatPurgeExtentCache( Vcb );
+
             //
             //  Clean the volume
             //
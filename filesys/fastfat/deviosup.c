@@ -138,6 +138,12 @@ FatSingleNonAlignedSync (
     IN PIRP Irp
     );
 
+VOID
+FatSortIoRunsByLbo (
+    IN OUT PIO_RUN IoRuns,
+    IN ULONG RunCount
+    );
+
 //
 //  The following macro decides whether to send a request directly to
 //  the device driver, or to other routines.  It was meant to
@@ -185,6 +191,7 @@ FatSingleNonAlignedSync (
 #pragma alloc_text(PAGE, FatMultipleAsync)
 #pragma alloc_text(PAGE, FatSingleAsync)
 #pragma alloc_text(PAGE, FatSingleNonAlignedSync)
+#pragma alloc_text(PAGE, FatSortIoRunsByLbo)
 #pragma alloc_text(PAGE, FatWaitSync)
 #pragma alloc_text(PAGE, FatLockUserBuffer)
 #pragma alloc_text(PAGE, FatBufferUserBuffer)
@@ -932,7 +939,10 @@ Return Value:
     ULONG BufferOffset;
     ULONG OriginalByteCount;
 
-
+    ULONG QueueDepth;
+    ULONG IssuedRuns;
+    ULONG RunsThisPass;
+    PMDL ZeroMdl;
 
     IO_RUN StackIoRuns[FAT_MAX_IO_RUNS_ON_STACK];
     PIO_RUN IoRuns;
@@ -1238,6 +1248,33 @@ Return Value:
                                FlagOn(IrpContext->Flags, IRP_CONTEXT_FLAG_USER_IO), NextRun);
         }
 
+        //
+        //  Each run carries its own buffer offset, and the completion
+        //  routines do not care which run finishes first, so put reads in
+        //  Lbo order.  Media that do poorly with seeks will then see the
+        //  requests arrive as close to sequential as the file allows.
+        //
+
+        if (IrpContext->MajorFunction == IRP_MJ_READ) {
+
+            FatSortIoRunsByLbo( IoRuns, NextRun );
+        }
+
+        //
+        //  If we can wait and there is a limit on the number of runs in
+        //  flight, work through the runs that many at a time.  We wait for
+        //  all but the last pass here, and the zeroing of the tail of the
+        //  buffer is held back until the last pass so a late run can't land
+        //  on top of it.
+        //
+
+        QueueDepth = FatData.NonCachedQueueDepth;
+
+        if (!Wait || (QueueDepth == 0) || (QueueDepth >= NextRun)) {
+
+            QueueDepth = NextRun;
+        }
+
         //
         //  OK, now do the I/O.
         //
@@ -1246,14 +1283,45 @@ Return Value:
 
             DebugTrace( 0, Dbg, "Passing Multiple Irps on to Disk Driver\n", 0 );
 
-            FatMultipleAsync( IrpContext,
-                              FcbOrDcb->Vcb,
-                              Irp,
-                              NextRun,
-                              IoRuns );
+            ZeroMdl = IrpContext->FatIoContext->ZeroMdl;
+            IrpContext->FatIoContext->ZeroMdl = NULL;
+
+            for (IssuedRuns = 0; IssuedRuns < NextRun; IssuedRuns += RunsThisPass) {
+
+                RunsThisPass = NextRun - IssuedRuns;
+
+                if (RunsThisPass > QueueDepth) {
+
+                    RunsThisPass = QueueDepth;
+                }
+
+                DebugTrace( 0, Dbg, "Runs in flight = %08lx\n", RunsThisPass );
+
+                if (IssuedRuns + RunsThisPass == NextRun) {
+
+                    IrpContext->FatIoContext->ZeroMdl = ZeroMdl;
+                }
+
+                FatMultipleAsync( IrpContext,
+                                  FcbOrDcb->Vcb,
+                                  Irp,
+                                  RunsThisPass,
+                                  &IoRuns[IssuedRuns] );
+
+                if (IssuedRuns + RunsThisPass != NextRun) {
+
+                    FatWaitSync( IrpContext );
+                }
+            }
 
         } finally {
 
+            if (IrpContext->FatIoContext->ZeroMdl == NULL) {
+
+                IrpContext->FatIoContext->ZeroMdl = ZeroMdl;
+            }
+
+
             if (IoRuns != StackIoRuns) {
 
                 ExFreePool( IoRuns );
@@ -3695,3 +3763,51 @@ Return Value:
 }
 
 
+//
+// Internal Support Routine
+//
+
+VOID
+FatSortIoRunsByLbo (
+    IN OUT PIO_RUN IoRuns,
+    IN ULONG RunCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sorts an array of runs into ascending Lbo order.  The
+    array is almost always short and usually close to sorted already, so
+    an insertion sort does nicely.
+
+Arguments:
+
+    IoRuns - Supplies the runs to sort.
+
+    RunCount - Supplies the number of runs.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    IO_RUN Run;
+    ULONG i, j;
+
+    PAGED_CODE();
+
+    for (i = 1; i < RunCount; i++) {
+
+        Run = IoRuns[i];
+
+        for (j = i; (j > 0) && (IoRuns[j - 1].Lbo > Run.Lbo); j--) {
+
+            IoRuns[j] = IoRuns[j - 1];
+        }
+
+        IoRuns[j] = Run;
+    }
+}
@@ -146,6 +146,18 @@ if ((VBO) >= (DCB)->Header.AllocationSize.LowPart) {              \
     *(DIRENT) = (PVOID)((PUCHAR)*(DIRENT) + ((VBO) % PAGE_SIZE)); \
 }
 
+//
+//  Dirent index tuning.  A lookup gives up on the index and searches the
+//  directory when more than FAT_DIRENT_INDEX_MAX_CANDIDATES sets hash the
+//  same as the name it wants.  Hashing is FNV-1a.
+//
+
+#define FAT_DIRENT_INDEX_MAX_CANDIDATES  (16)
+#define FAT_DIRENT_INDEX_MAX_BUCKETS     (0x8000)
+
+#define FAT_DIRENT_INDEX_HASH_BASIS      (0x811c9dc5)
+#define FAT_DIRENT_INDEX_HASH_PRIME      (0x01000193)
+
 //
 //  Internal support routines
 //
@@ -170,25 +182,136 @@ FatDefragDirectory (
     IN ULONG DirentsNeeded
     );
 
+_Requires_lock_held_(_Global_critical_region_)
+VOID
+FatScanForDirent (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB ParentDirectory,
+    IN PCCB Ccb,
+    IN VBO OffsetToStartSearchFrom,
+    IN VBO OffsetToEndSearchAt,
+    IN OUT PULONG Flags,
+    OUT PDIRENT *Dirent,
+    OUT PBCB *Bcb,
+    OUT PVBO ByteOffset,
+    OUT PBOOLEAN FileNameDos OPTIONAL,
+    IN OUT PUNICODE_STRING LongFileName OPTIONAL,
+    IN OUT PUNICODE_STRING OrigLongFileName OPTIONAL,
+    OUT PULONG DirentsScanned OPTIONAL
+    );
+
+ULONG
+FatHashDirentShortName (
+    IN PUCHAR FileName
+    );
+
+ULONG
+FatHashDirentLongName (
+    IN PUNICODE_STRING Name
+    );
+
+BOOLEAN
+FatIsDirentIndexUsable (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb,
+    IN PCCB Ccb,
+    IN VBO OffsetToStartSearchFrom
+    );
+
+VOID
+FatFreeDirentIndex (
+    IN PFAT_DIRENT_INDEX Index
+    );
+
+PFAT_DIRENT_INDEX
+FatAllocateDirentIndex (
+    IN PDCB Dcb
+    );
+
+BOOLEAN
+FatAddToDirentIndex (
+    IN PFAT_DIRENT_INDEX Index,
+    IN VBO DirentOffset,
+    IN PDIRENT Dirent,
+    IN PUNICODE_STRING Lfn
+    );
+
+VOID
+FatUnlinkDirentIndexEntry (
+    IN PFAT_DIRENT_INDEX Index,
+    IN ULONG Chain,
+    IN ULONG EntryIndex
+    );
+
+VOID
+FatRemoveFromDirentIndex (
+    IN PFAT_DIRENT_INDEX Index,
+    IN VBO DirentOffset,
+    IN PDIRENT Dirent
+    );
+
+_Requires_lock_held_(_Global_critical_region_)
+VOID
+FatBuildDirentIndex (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb
+    );
+
+_Requires_lock_held_(_Global_critical_region_)
+VOID
+FatResolvePendingDirents (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb
+    );
+
+_Requires_lock_held_(_Global_critical_region_)
+BOOLEAN
+FatLookupDirentIndex (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB ParentDirectory,
+    IN PCCB Ccb,
+    IN OUT PULONG Flags,
+    OUT PDIRENT *Dirent,
+    OUT PBCB *Bcb,
+    OUT PVBO ByteOffset,
+    OUT PBOOLEAN FileNameDos OPTIONAL,
+    IN OUT PUNICODE_STRING LongFileName OPTIONAL,
+    IN OUT PUNICODE_STRING OrigLongFileName OPTIONAL
+    );
+
 
 #ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, FatAddToDirentIndex)
+#pragma alloc_text(PAGE, FatAllocateDirentIndex)
+#pragma alloc_text(PAGE, FatBuildDirentIndex)
 #pragma alloc_text(PAGE, FatComputeLfnChecksum)
 #pragma alloc_text(PAGE, FatConstructDirent)
 #pragma alloc_text(PAGE, FatConstructLabelDirent)
 #pragma alloc_text(PAGE, FatCreateNewDirent)
 #pragma alloc_text(PAGE, FatDefragDirectory)
 #pragma alloc_text(PAGE, FatDeleteDirent)
+#pragma alloc_text(PAGE, FatFreeDirentIndex)
 #pragma alloc_text(PAGE, FatGetDirentFromFcbOrDcb)
+#pragma alloc_text(PAGE, FatHashDirentLongName)
+#pragma alloc_text(PAGE, FatHashDirentShortName)
 #pragma alloc_text(PAGE, FatInitializeDirectoryDirent)
 #pragma alloc_text(PAGE, FatIsDirectoryEmpty)
+#pragma alloc_text(PAGE, FatIsDirentIndexUsable)
 #pragma alloc_text(PAGE, FatLfnDirentExists)
 #pragma alloc_text(PAGE, FatLocateDirent)
 #pragma alloc_text(PAGE, FatLocateSimpleOemDirent)
 #pragma alloc_text(PAGE, FatLocateVolumeLabel)
+#pragma alloc_text(PAGE, FatLookupDirentIndex)
+#pragma alloc_text(PAGE, FatNoteDirentsInIndex)
+#pragma alloc_text(PAGE, FatRemoveFromDirentIndex)
 #pragma alloc_text(PAGE, FatRescanDirectory)
+#pragma alloc_text(PAGE, FatResolvePendingDirents)
+#pragma alloc_text(PAGE, FatScanForDirent)
 #pragma alloc_text(PAGE, FatSetFileSizeInDirent)
 #pragma alloc_text(PAGE, FatSetFileSizeInDirentNoRaise)
+#pragma alloc_text(PAGE, FatTearDownDirentIndex)
 #pragma alloc_text(PAGE, FatTunnelFcbOrDcb)
+#pragma alloc_text(PAGE, FatUnlinkDirentIndexEntry)
 #pragma alloc_text(PAGE, FatUpdateDirentFromFcb)
 
 
@@ -540,6 +663,12 @@ Return Value:
     ParentDirectory->Specific.Dcb.UnusedDirentVbo = UnusedVbo;
     ParentDirectory->Specific.Dcb.DeletedDirentHint = DeletedHint;
 
+    //
+    //  Let the dirent index know a new set is on the way.
+    //
+
+    FatNoteDirentsInIndex( IrpContext, ParentDirectory, ByteOffset, DirentsNeeded );
+
     DebugTrace(-1, Dbg, "FatCreateNewDirent -> (VOID)\n", 0);
 
     return ByteOffset;
@@ -904,6 +1033,20 @@ Return Value:
             }
 
             NT_ASSERT( (Dirent->FirstClusterOfFile == 0) || !DeleteEa );
+
+            //
+            //  Take the set out of the dirent index while the short name
+            //  is still intact.
+            //
+
+            if ((Offset == FcbOrDcb->DirentOffsetWithinDirectory) &&
+                (FcbOrDcb->ParentDcb->Specific.Dcb.DirentIndex != NULL)) {
+
+                FatRemoveFromDirentIndex( FcbOrDcb->ParentDcb->Specific.Dcb.DirentIndex,
+                                          Offset,
+                                          Dirent );
+            }
+
             Dirent->FileName[0] = FAT_DIRENT_DELETED;
         }
 
@@ -1124,6 +1267,114 @@ Return Value:
 
 --*/
 
+{
+    ULONG DirentsScanned = 0;
+    BOOLEAN UseIndex;
+
+    PAGED_CODE();
+
+    //
+    //  A simple name lookup in a large directory can be answered from the
+    //  dirent index, if the directory has one.
+    //
+
+    UseIndex = FatIsDirentIndexUsable( IrpContext,
+                                       ParentDirectory,
+                                       Ccb,
+                                       OffsetToStartSearchFrom );
+
+    if (UseIndex &&
+        (ParentDirectory->Specific.Dcb.DirentIndex != NULL) &&
+        FatLookupDirentIndex( IrpContext,
+                              ParentDirectory,
+                              Ccb,
+                              Flags,
+                              Dirent,
+                              Bcb,
+                              ByteOffset,
+                              FileNameDos,
+                              LongFileName,
+                              OrigLongFileName )) {
+
+        return;
+    }
+
+    FatScanForDirent( IrpContext,
+                      ParentDirectory,
+                      Ccb,
+                      OffsetToStartSearchFrom,
+                      MAXULONG,
+                      Flags,
+                      Dirent,
+                      Bcb,
+                      ByteOffset,
+                      FileNameDos,
+                      LongFileName,
+                      OrigLongFileName,
+                      &DirentsScanned );
+
+    //
+    //  If that was a long walk, build an index so the next lookup in this
+    //  directory doesn't have to repeat it.
+    //
+
+    if (UseIndex &&
+        (ParentDirectory->Specific.Dcb.DirentIndex == NULL) &&
+        (DirentsScanned >= FAT_DIRENT_INDEX_THRESHOLD)) {
+
+        FatBuildDirentIndex( IrpContext, ParentDirectory );
+    }
+
+    return;
+}
+
+
+//
+//  Internal support routine
+//
+
+_Requires_lock_held_(_Global_critical_region_)
+VOID
+FatScanForDirent (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB ParentDirectory,
+    IN PCCB Ccb,
+    IN VBO OffsetToStartSearchFrom,
+    IN VBO OffsetToEndSearchAt,
+    IN OUT PULONG Flags,
+    OUT PDIRENT *Dirent,
+    OUT PBCB *Bcb,
+    OUT PVBO ByteOffset,
+    OUT PBOOLEAN FileNameDos OPTIONAL,
+    IN OUT PUNICODE_STRING LongFileName OPTIONAL,
+    IN OUT PUNICODE_STRING OrigLongFileName OPTIONAL,
+    OUT PULONG DirentsScanned OPTIONAL
+    )
+
+/*++
+
+Routine Description:
+
+    This routine walks the directory looking for an undeleted dirent
+    matching a given name.  It is the worker for FatLocateDirent.
+
+Arguments:
+
+    OffsetToEndSearchAt - Supplies the VBO within the parent directory at
+        which to stop looking.  Reaching it is treated as reaching the end
+        of the directory.
+
+    DirentsScanned - If specified, receives the number of dirents walked
+        over before the search ended.
+
+    See FatLocateDirent for the remaining arguments.
+
+Return Value:
+
+    None.
+
+--*/
+
 {
     NTSTATUS Status = STATUS_SUCCESS;
 
@@ -1141,12 +1392,13 @@ Return Value:
     ULONG LfnIndex = 0;
     UCHAR Ordinal = 0;
     VBO LfnByteOffset = 0;
+    ULONG Scanned = 0;
 
     TimerStart(Dbg);
 
     PAGED_CODE();
 
-    DebugTrace(+1, Dbg, "FatLocateDirent\n", 0);
+    DebugTrace(+1, Dbg, "FatScanForDirent\n", 0);
 
     DebugTrace( 0, Dbg, "  ParentDirectory         = %p\n", ParentDirectory);
     DebugTrace( 0, Dbg, "  OffsetToStartSearchFrom = %08lx\n", OffsetToStartSearchFrom);
@@ -1253,15 +1505,23 @@ Return Value:
             UpcasedLfnValid = FALSE;
             
             //
-            //  Try to read in the dirent
+            //  Try to read in the dirent, unless we have reached the end of
+            //  the range we were asked to search.
             //
 
-            FatReadDirent( IrpContext,
-                           ParentDirectory,
-                           *ByteOffset,
-                           Bcb,
-                           Dirent,
-                           &Status );
+            if (*ByteOffset < OffsetToEndSearchAt) {
+
+                FatReadDirent( IrpContext,
+                               ParentDirectory,
+                               *ByteOffset,
+                               Bcb,
+                               Dirent,
+                               &Status );
+
+            } else {
+
+                Status = STATUS_END_OF_FILE;
+            }
 
             //
             //  If End Directory dirent or EOF, set all out parameters to
@@ -1694,6 +1954,7 @@ GetNextDirent:
 
             *ByteOffset += sizeof(DIRENT);
             *Dirent += 1;
+            Scanned += 1;
         }
 
     } finally {
@@ -1703,9 +1964,14 @@ GetNextDirent:
         
     }
 
-    DebugTrace(-1, Dbg, "FatLocateDirent -> (VOID)\n", 0);
+    if (ARGUMENT_PRESENT( DirentsScanned )) {
+
+        *DirentsScanned = Scanned;
+    }
+
+    DebugTrace(-1, Dbg, "FatScanForDirent -> (VOID)\n", 0);
 
-    TimerStop(Dbg,"FatLocateDirent");
+    TimerStop(Dbg,"FatScanForDirent");
 
     return;
 }
@@ -3469,6 +3735,12 @@ Return Value:
         return (ULONG)-1;
     }
 
+    //
+    //  Every dirent set may move, so any index of the directory is useless.
+    //
+
+    FatTearDownDirentIndex( IrpContext, Dcb );
+
     //
     //  Force wait to TRUE
     //
@@ -3876,4 +4148,1008 @@ Return Value:
 }
 
 
+//
+//  Internal support routine
+//
+
+ULONG
+FatHashDirentShortName (
+    IN PUCHAR FileName
+    )
+
+/*++
+
+Routine Description:
+
+    This routine computes the dirent index hash of an 11 byte short name,
+    as it is found in a dirent or a constant Oem query template.
+
+Arguments:
+
+    FileName - Supplies the name to hash.
+
+Return Value:
+
+    ULONG - The hash.
+
+--*/
+
+{
+    ULONG Hash = FAT_DIRENT_INDEX_HASH_BASIS;
+    ULONG i;
+
+    PAGED_CODE();
+
+    for (i = 0; i < 11; i++) {
+
+        Hash = (Hash ^ FileName[i]) * FAT_DIRENT_INDEX_HASH_PRIME;
+    }
+
+    return Hash;
+}
+
+
+//
+//  Internal support routine
+//
+
+ULONG
+FatHashDirentLongName (
+    IN PUNICODE_STRING Name
+    )
+
+/*++
+
+Routine Description:
+
+    This routine computes the dirent index hash of a long name.  The name
+    is upcased a character at a time, so that a name found on disk hashes
+    the same as the upcased query template we will later compare it with.
+
+Arguments:
+
+    Name - Supplies the name to hash.
+
+Return Value:
+
+    ULONG - The hash.
+
+--*/
+
+{
+    ULONG Hash = FAT_DIRENT_INDEX_HASH_BASIS;
+    WCHAR Char;
+    ULONG i;
+
+    PAGED_CODE();
+
+    for (i = 0; i < Name->Length / sizeof(WCHAR); i++) {
+
+        Char = RtlUpcaseUnicodeChar( Name->Buffer[i] );
+
+        Hash = (Hash ^ (Char & 0xff)) * FAT_DIRENT_INDEX_HASH_PRIME;
+        Hash = (Hash ^ (Char >> 8)) * FAT_DIRENT_INDEX_HASH_PRIME;
+    }
+
+    return Hash;
+}
+
+
+//
+//  Internal support routine
+//
+
+BOOLEAN
+FatIsDirentIndexUsable (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb,
+    IN PCCB Ccb,
+    IN VBO OffsetToStartSearchFrom
+    )
+
+/*++
+
+Routine Description:
+
+    This routine decides whether a FatLocateDirent call may be answered
+    from, or may build, the dirent index of the directory.  Only a search
+    for a constant name from the start of the directory qualifies, and only
+    when we hold the directory exclusive, since the index is updated under
+    the same locks that protect the dirents themselves.
+
+Arguments:
+
+    Dcb - Supplies the directory being searched.
+
+    Ccb - Supplies the matching information for the search.
+
+    OffsetToStartSearchFrom - Supplies where the search starts.
+
+Return Value:
+
+    BOOLEAN - TRUE if the index may be used.
+
+--*/
+
+{
+    PAGED_CODE();
+
+    if ((OffsetToStartSearchFrom != 0) ||
+        Ccb->ContainsWildCards ||
+        FlagOn( Ccb->Flags, CCB_FLAG_MATCH_ALL | CCB_FLAG_MATCH_VOLUME_ID ) ||
+        !FlagOn( IrpContext->Flags, IRP_CONTEXT_FLAG_WAIT ) ||
+        (Dcb->FcbCondition != FcbGood)) {
+
+        return FALSE;
+    }
+
+    return (ExIsResourceAcquiredExclusiveLite( &Dcb->Vcb->Resource ) ||
+            (ExIsResourceAcquiredExclusiveLite( Dcb->Header.Resource ) &&
+             ExIsResourceAcquiredSharedLite( &Dcb->Vcb->Resource )));
+}
+
+
+//
+//  Internal support routine
+//
+
+VOID
+FatFreeDirentIndex (
+    IN PFAT_DIRENT_INDEX Index
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees a dirent index and its tables.
+
+Arguments:
+
+    Index - Supplies the index to free.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PAGED_CODE();
+
+    if (Index->Buckets[FAT_DIRENT_INDEX_SHORT] != NULL) {
+
+        ExFreePool( Index->Buckets[FAT_DIRENT_INDEX_SHORT] );
+    }
+
+    if (Index->Buckets[FAT_DIRENT_INDEX_LONG] != NULL) {
+
+        ExFreePool( Index->Buckets[FAT_DIRENT_INDEX_LONG] );
+    }
+
+    if (Index->Entries != NULL) {
+
+        ExFreePool( Index->Entries );
+    }
+
+    ExFreePool( Index );
+}
+
+
+//
+//  Internal support routine
+//
+
+PFAT_DIRENT_INDEX
+FatAllocateDirentIndex (
+    IN PDCB Dcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates an empty dirent index sized for the current
+    allocation of the directory.  The index is only an optimization so,
+    unlike most allocations in the file system, failure does not raise.
+
+Arguments:
+
+    Dcb - Supplies the directory the index is for.
+
+Return Value:
+
+    PFAT_DIRENT_INDEX - The new index, or NULL if there was not enough pool.
+
+--*/
+
+{
+    PFAT_DIRENT_INDEX Index;
+    ULONG BucketCount;
+
+    PAGED_CODE();
+
+    //
+    //  Aim for a bucket for every two dirents, which with long names in the
+    //  picture is roughly a bucket per name.
+    //
+
+    BucketCount = 64;
+
+    while ((BucketCount < FAT_DIRENT_INDEX_MAX_BUCKETS) &&
+           (BucketCount < Dcb->Header.AllocationSize.LowPart / (2 * sizeof(DIRENT)))) {
+
+        BucketCount <<= 1;
+    }
+
+    Index = ExAllocatePoolWithTag( PagedPool,
+                                   sizeof(FAT_DIRENT_INDEX),
+                                   TAG_DIRENT_INDEX );
+
+    if (Index == NULL) {
+
+        return NULL;
+    }
+
+    RtlZeroMemory( Index, sizeof(FAT_DIRENT_INDEX) );
+
+    Index->BucketMask = BucketCount - 1;
+    Index->EntryMax = BucketCount;
+    Index->FreeEntry = FAT_DIRENT_INDEX_NIL;
+
+    Index->Buckets[FAT_DIRENT_INDEX_SHORT] = ExAllocatePoolWithTag( PagedPool,
+                                                                    BucketCount * sizeof(ULONG),
+                                                                    TAG_DIRENT_INDEX );
+
+    Index->Buckets[FAT_DIRENT_INDEX_LONG] = ExAllocatePoolWithTag( PagedPool,
+                                                                   BucketCount * sizeof(ULONG),
+                                                                   TAG_DIRENT_INDEX );
+
+    Index->Entries = ExAllocatePoolWithTag( PagedPool,
+                                            BucketCount * sizeof(FAT_DIRENT_INDEX_ENTRY),
+                                            TAG_DIRENT_INDEX );
+
+    if ((Index->Buckets[FAT_DIRENT_INDEX_SHORT] == NULL) ||
+        (Index->Buckets[FAT_DIRENT_INDEX_LONG] == NULL) ||
+        (Index->Entries == NULL)) {
+
+        FatFreeDirentIndex( Index );
+        return NULL;
+    }
+
+    //
+    //  An all-ones bucket is FAT_DIRENT_INDEX_NIL, an empty chain.
+    //
+
+    RtlFillMemory( Index->Buckets[FAT_DIRENT_INDEX_SHORT], BucketCount * sizeof(ULONG), 0xff );
+    RtlFillMemory( Index->Buckets[FAT_DIRENT_INDEX_LONG], BucketCount * sizeof(ULONG), 0xff );
+
+    return Index;
+}
+
+
+//
+//  Internal support routine
+//
+
+BOOLEAN
+FatAddToDirentIndex (
+    IN PFAT_DIRENT_INDEX Index,
+    IN VBO DirentOffset,
+    IN PDIRENT Dirent,
+    IN PUNICODE_STRING Lfn
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds a dirent set to the index.
+
+Arguments:
+
+    Index - Supplies the index to add to.
+
+    DirentOffset - Supplies the offset of the short dirent of the set.
+
+    Dirent - Supplies the short dirent of the set.
+
+    Lfn - Supplies the long name of the set, with a zero Length if the set
+        has none.
+
+Return Value:
+
+    BOOLEAN - FALSE if the index could not be grown to hold the entry.
+
+--*/
+
+{
+    PFAT_DIRENT_INDEX_ENTRY Entry;
+    PFAT_DIRENT_INDEX_ENTRY NewEntries;
+    ULONG EntryIndex;
+    ULONG Bucket;
+
+    PAGED_CODE();
+
+    if (Index->FreeEntry != FAT_DIRENT_INDEX_NIL) {
+
+        EntryIndex = Index->FreeEntry;
+        Index->FreeEntry = Index->Entries[EntryIndex].Next[FAT_DIRENT_INDEX_SHORT];
+
+    } else {
+
+        if (Index->EntryCount == Index->EntryMax) {
+
+            NewEntries = ExAllocatePoolWithTag( PagedPool,
+                                                Index->EntryMax * 2 * sizeof(FAT_DIRENT_INDEX_ENTRY),
+                                                TAG_DIRENT_INDEX );
+
+            if (NewEntries == NULL) {
+
+                return FALSE;
+            }
+
+            RtlCopyMemory( NewEntries,
+                           Index->Entries,
+                           Index->EntryMax * sizeof(FAT_DIRENT_INDEX_ENTRY) );
+
+            ExFreePool( Index->Entries );
+
+            Index->Entries = NewEntries;
+            Index->EntryMax *= 2;
+        }
+
+        EntryIndex = Index->EntryCount;
+        Index->EntryCount += 1;
+    }
+
+    Entry = &Index->Entries[EntryIndex];
+
+    Entry->DirentOffset = DirentOffset;
+    Entry->DirentCount = 1;
+
+    Entry->Hash[FAT_DIRENT_INDEX_SHORT] = FatHashDirentShortName( &Dirent->FileName[0] );
+
+    Bucket = Entry->Hash[FAT_DIRENT_INDEX_SHORT] & Index->BucketMask;
+    Entry->Next[FAT_DIRENT_INDEX_SHORT] = Index->Buckets[FAT_DIRENT_INDEX_SHORT][Bucket];
+    Index->Buckets[FAT_DIRENT_INDEX_SHORT][Bucket] = EntryIndex;
+
+    //
+    //  Only sets with a long name go on the long name chains.
+    //
+
+    if (Lfn->Length != 0) {
+
+        Entry->DirentCount += FAT_LFN_DIRENTS_NEEDED( Lfn );
+
+        Entry->Hash[FAT_DIRENT_INDEX_LONG] = FatHashDirentLongName( Lfn );
+
+        Bucket = Entry->Hash[FAT_DIRENT_INDEX_LONG] & Index->BucketMask;
+        Entry->Next[FAT_DIRENT_INDEX_LONG] = Index->Buckets[FAT_DIRENT_INDEX_LONG][Bucket];
+        Index->Buckets[FAT_DIRENT_INDEX_LONG][Bucket] = EntryIndex;
+
+    } else {
+
+        Entry->Hash[FAT_DIRENT_INDEX_LONG] = 0;
+        Entry->Next[FAT_DIRENT_INDEX_LONG] = FAT_DIRENT_INDEX_NIL;
+    }
+
+    return TRUE;
+}
+
+
+//
+//  Internal support routine
+//
+
+VOID
+FatUnlinkDirentIndexEntry (
+    IN PFAT_DIRENT_INDEX Index,
+    IN ULONG Chain,
+    IN ULONG EntryIndex
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes an entry from one of its two hash chains.
+
+Arguments:
+
+    Index - Supplies the index.
+
+    Chain - Supplies FAT_DIRENT_INDEX_SHORT or FAT_DIRENT_INDEX_LONG.
+
+    EntryIndex - Supplies the entry to unlink.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PULONG Link;
+
+    PAGED_CODE();
+
+    Link = &Index->Buckets[Chain][Index->Entries[EntryIndex].Hash[Chain] & Index->BucketMask];
+
+    while (*Link != FAT_DIRENT_INDEX_NIL) {
+
+        if (*Link == EntryIndex) {
+
+            *Link = Index->Entries[EntryIndex].Next[Chain];
+            break;
+        }
+
+        Link = &Index->Entries[*Link].Next[Chain];
+    }
+}
+
+
+//
+//  Internal support routine
+//
+
+VOID
+FatRemoveFromDirentIndex (
+    IN PFAT_DIRENT_INDEX Index,
+    IN VBO DirentOffset,
+    IN PDIRENT Dirent
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes the entry for a dirent set that is being deleted.
+    It must be called before the short dirent is marked deleted.
+
+Arguments:
+
+    Index - Supplies the index.
+
+    DirentOffset - Supplies the offset of the short dirent of the set.
+
+    Dirent - Supplies the short dirent of the set.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    ULONG EntryIndex;
+    ULONG Hash;
+
+    PAGED_CODE();
+
+    Hash = FatHashDirentShortName( &Dirent->FileName[0] );
+
+    for (EntryIndex = Index->Buckets[FAT_DIRENT_INDEX_SHORT][Hash & Index->BucketMask];
+         EntryIndex != FAT_DIRENT_INDEX_NIL;
+         EntryIndex = Index->Entries[EntryIndex].Next[FAT_DIRENT_INDEX_SHORT]) {
+
+        if ((Index->Entries[EntryIndex].DirentOffset == DirentOffset) &&
+            (Index->Entries[EntryIndex].Hash[FAT_DIRENT_INDEX_SHORT] == Hash)) {
+
+            break;
+        }
+    }
+
+    if (EntryIndex == FAT_DIRENT_INDEX_NIL) {
+
+        return;
+    }
+
+    FatUnlinkDirentIndexEntry( Index, FAT_DIRENT_INDEX_SHORT, EntryIndex );
+
+    if (Index->Entries[EntryIndex].DirentCount > 1) {
+
+        FatUnlinkDirentIndexEntry( Index, FAT_DIRENT_INDEX_LONG, EntryIndex );
+    }
+
+    Index->Entries[EntryIndex].DirentCount = 0;
+    Index->Entries[EntryIndex].Next[FAT_DIRENT_INDEX_SHORT] = Index->FreeEntry;
+    Index->FreeEntry = EntryIndex;
+}
+
+
+//
+//  Internal support routine
+//
+
+_Requires_lock_held_(_Global_critical_region_)
+VOID
+FatBuildDirentIndex (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine walks a directory and builds its dirent index.  If pool
+    runs short we simply go without, and the directory continues to be
+    searched linearly.
+
+Arguments:
+
+    Dcb - Supplies the directory to index.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PFAT_DIRENT_INDEX Index;
+
+    CCB LocalCcb;
+    ULONG Flags = 0;
+
+    PDIRENT Dirent = NULL;
+    PBCB Bcb = NULL;
+    VBO ByteOffset = 0;
+    VBO Offset = 0;
+
+    UNICODE_STRING Lfn;
+    WCHAR LfnBuffer[32];
+
+    PAGED_CODE();
+
+    DebugTrace(+1, Dbg, "FatBuildDirentIndex, Dcb = %p\n", Dcb);
+
+    Index = FatAllocateDirentIndex( Dcb );
+
+    if (Index == NULL) {
+
+        DebugTrace(-1, Dbg, "FatBuildDirentIndex -> (VOID), no pool\n", 0);
+        return;
+    }
+
+    RtlZeroMemory( &LocalCcb, sizeof(CCB) );
+    LocalCcb.Flags = CCB_FLAG_MATCH_ALL;
+
+    Lfn.Length = 0;
+    Lfn.MaximumLength = sizeof(LfnBuffer);
+    Lfn.Buffer = LfnBuffer;
+
+    try {
+
+        while (TRUE) {
+
+            FatScanForDirent( IrpContext,
+                              Dcb,
+                              &LocalCcb,
+                              Offset,
+                              MAXULONG,
+                              &Flags,
+                              &Dirent,
+                              &Bcb,
+                              &ByteOffset,
+                              NULL,
+                              &Lfn,
+                              NULL,
+                              NULL );
+
+            if (Dirent == NULL) {
+
+                break;
+            }
+
+            if (!FatAddToDirentIndex( Index, ByteOffset, Dirent, &Lfn )) {
+
+                try_return( NOTHING );
+            }
+
+            Offset = ByteOffset + sizeof(DIRENT);
+        }
+
+        Dcb->Specific.Dcb.DirentIndex = Index;
+        Index = NULL;
+
+    try_exit: NOTHING;
+    } finally {
+
+        DebugUnwind( FatBuildDirentIndex );
+
+        FatUnpinBcb( IrpContext, Bcb );
+        FatFreeStringBuffer( &Lfn );
+
+        if (Index != NULL) {
+
+            FatFreeDirentIndex( Index );
+        }
+
+        DebugTrace(-1, Dbg, "FatBuildDirentIndex -> (VOID)\n", 0);
+    }
+}
+
+
+//
+//  Internal support routine
+//
+
+_Requires_lock_held_(_Global_critical_region_)
+VOID
+FatResolvePendingDirents (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds the dirent sets that were allocated since the index
+    was built.  A set that we do not find written out at the expected place
+    is left pending and tried again on the next lookup.
+
+Arguments:
+
+    Dcb - Supplies the directory whose index is to be brought up to date.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PFAT_DIRENT_INDEX Index = Dcb->Specific.Dcb.DirentIndex;
+    ULONG Pending = 0;
+
+    CCB LocalCcb;
+    ULONG Flags = 0;
+
+    PDIRENT Dirent = NULL;
+    PBCB Bcb = NULL;
+    VBO ByteOffset = 0;
+    VBO LfnOffset;
+    ULONG DirentCount;
+
+    UNICODE_STRING Lfn;
+    WCHAR LfnBuffer[32];
+
+    PAGED_CODE();
+
+    RtlZeroMemory( &LocalCcb, sizeof(CCB) );
+    LocalCcb.Flags = CCB_FLAG_MATCH_ALL;
+
+    Lfn.Length = 0;
+    Lfn.MaximumLength = sizeof(LfnBuffer);
+    Lfn.Buffer = LfnBuffer;
+
+    try {
+
+        while (Pending < Index->PendingCount) {
+
+            LfnOffset = Index->Pending[Pending].LfnOffset;
+            DirentCount = Index->Pending[Pending].DirentCount;
+
+            FatScanForDirent( IrpContext,
+                              Dcb,
+                              &LocalCcb,
+                              LfnOffset,
+                              LfnOffset + DirentCount * sizeof(DIRENT),
+                              &Flags,
+                              &Dirent,
+                              &Bcb,
+                              &ByteOffset,
+                              NULL,
+                              &Lfn,
+                              NULL,
+                              NULL );
+
+            if ((Dirent == NULL) ||
+                (ByteOffset != LfnOffset + (DirentCount - 1) * sizeof(DIRENT))) {
+
+                Pending += 1;
+                continue;
+            }
+
+            if (!FatAddToDirentIndex( Index, ByteOffset, Dirent, &Lfn )) {
+
+                FatTearDownDirentIndex( IrpContext, Dcb );
+                try_return( NOTHING );
+            }
+
+            Index->PendingCount -= 1;
+            Index->Pending[Pending] = Index->Pending[Index->PendingCount];
+        }
+
+    try_exit: NOTHING;
+    } finally {
+
+        DebugUnwind( FatResolvePendingDirents );
+
+        FatUnpinBcb( IrpContext, Bcb );
+        FatFreeStringBuffer( &Lfn );
+    }
+}
+
+
+//
+//  Internal support routine
+//
+
+_Requires_lock_held_(_Global_critical_region_)
+BOOLEAN
+FatLookupDirentIndex (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB ParentDirectory,
+    IN PCCB Ccb,
+    IN OUT PULONG Flags,
+    OUT PDIRENT *Dirent,
+    OUT PBCB *Bcb,
+    OUT PVBO ByteOffset,
+    OUT PBOOLEAN FileNameDos OPTIONAL,
+    IN OUT PUNICODE_STRING LongFileName OPTIONAL,
+    IN OUT PUNICODE_STRING OrigLongFileName OPTIONAL
+    )
+
+/*++
+
+Routine Description:
+
+    This routine answers a FatLocateDirent call from the dirent index.
+    Every dirent set whose short or long name hashes the same as the name
+    we are looking for is searched, in directory order, with the normal
+    matching rules.  If none of them match, the name is not in the
+    directory.
+
+Arguments:
+
+    See FatLocateDirent.
+
+Return Value:
+
+    BOOLEAN - TRUE if the outputs of FatLocateDirent have been filled in,
+        FALSE if the caller must search the directory itself.
+
+--*/
+
+{
+    PFAT_DIRENT_INDEX Index;
+    PFAT_DIRENT_INDEX_ENTRY Entry;
+    ULONG EntryIndex;
+    ULONG Hash;
+    ULONG Chain;
+
+    VBO CandidateOffset[FAT_DIRENT_INDEX_MAX_CANDIDATES];
+    ULONG CandidateCount[FAT_DIRENT_INDEX_MAX_CANDIDATES];
+    ULONG Candidates = 0;
+    ULONG i, j;
+
+    PAGED_CODE();
+
+    FatResolvePendingDirents( IrpContext, ParentDirectory );
+
+    Index = ParentDirectory->Specific.Dcb.DirentIndex;
+
+    if (Index == NULL) {
+
+        return FALSE;
+    }
+
+    //
+    //  Gather the candidates from both chains, sorted by offset and without
+    //  duplicates.  If a name is unlucky enough to collide with very many
+    //  others, just search the directory.
+    //
+
+    for (Chain = FAT_DIRENT_INDEX_SHORT; Chain <= FAT_DIRENT_INDEX_LONG; Chain++) {
+
+        if (Chain == FAT_DIRENT_INDEX_SHORT) {
+
+            if (FlagOn( Ccb->Flags, CCB_FLAG_SKIP_SHORT_NAME_COMPARE )) {
+
+                continue;
+            }
+
+            Hash = FatHashDirentShortName( &Ccb->OemQueryTemplate.Constant[0] );
+
+        } else {
+
+            if (!FatData.ChicagoMode ||
+                !ARGUMENT_PRESENT( LongFileName ) ||
+                (Ccb->UnicodeQueryTemplate.Length == 0)) {
+
+                continue;
+            }
+
+            Hash = FatHashDirentLongName( &Ccb->UnicodeQueryTemplate );
+        }
+
+        for (EntryIndex = Index->Buckets[Chain][Hash & Index->BucketMask];
+             EntryIndex != FAT_DIRENT_INDEX_NIL;
+             EntryIndex = Entry->Next[Chain]) {
+
+            Entry = &Index->Entries[EntryIndex];
+
+            if (Entry->Hash[Chain] != Hash) {
+
+                continue;
+            }
+
+            for (i = 0; (i < Candidates) && (CandidateOffset[i] < Entry->DirentOffset); i++) {
+
+                NOTHING;
+            }
+
+            if ((i < Candidates) && (CandidateOffset[i] == Entry->DirentOffset)) {
+
+                continue;
+            }
+
+            if (Candidates == FAT_DIRENT_INDEX_MAX_CANDIDATES) {
+
+                return FALSE;
+            }
+
+            for (j = Candidates; j > i; j--) {
+
+                CandidateOffset[j] = CandidateOffset[j - 1];
+                CandidateCount[j] = CandidateCount[j - 1];
+            }
+
+            CandidateOffset[i] = Entry->DirentOffset;
+            CandidateCount[i] = Entry->DirentCount;
+            Candidates += 1;
+        }
+    }
+
+    //
+    //  Search each candidate set from its first dirent through its short
+    //  dirent.  An index entry left over from a set that has since changed
+    //  simply fails to match.
+    //
+
+    for (i = 0; i < Candidates; i++) {
+
+        FatScanForDirent( IrpContext,
+                          ParentDirectory,
+                          Ccb,
+                          CandidateOffset[i] - (CandidateCount[i] - 1) * sizeof(DIRENT),
+                          CandidateOffset[i] + sizeof(DIRENT),
+                          Flags,
+                          Dirent,
+                          Bcb,
+                          ByteOffset,
+                          FileNameDos,
+                          LongFileName,
+                          OrigLongFileName,
+                          NULL );
+
+        if (*Dirent != NULL) {
+
+            return TRUE;
+        }
+    }
+
+    //
+    //  Not found.  An empty search range gives us the outputs of a search
+    //  that ran off the end of the directory.
+    //
+
+    if (Candidates == 0) {
+
+        FatScanForDirent( IrpContext,
+                          ParentDirectory,
+                          Ccb,
+                          0,
+                          0,
+                          Flags,
+                          Dirent,
+                          Bcb,
+                          ByteOffset,
+                          FileNameDos,
+                          LongFileName,
+                          OrigLongFileName,
+                          NULL );
+    }
+
+    return TRUE;
+}
+
+
+VOID
+FatNoteDirentsInIndex (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb,
+    IN VBO LfnOffset,
+    IN ULONG DirentCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tells the dirent index of a directory, if it has one,
+    about a dirent set that is about to be written.  The set is added to
+    the index by the next lookup, once its names are on disk.
+
+Arguments:
+
+    Dcb - Supplies the directory.
+
+    LfnOffset - Supplies the offset of the first dirent of the set.
+
+    DirentCount - Supplies the number of dirents in the set.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PFAT_DIRENT_INDEX Index = Dcb->Specific.Dcb.DirentIndex;
+
+    PAGED_CODE();
+
+    if (Index == NULL) {
+
+        return;
+    }
+
+    //
+    //  If the directory is changing faster than it is being searched, the
+    //  index isn't earning its keep.
+    //
+
+    if (Index->PendingCount == FAT_DIRENT_INDEX_MAX_PENDING) {
+
+        FatTearDownDirentIndex( IrpContext, Dcb );
+        return;
+    }
+
+    Index->Pending[Index->PendingCount].LfnOffset = LfnOffset;
+    Index->Pending[Index->PendingCount].DirentCount = DirentCount;
+    Index->PendingCount += 1;
+}
+
+
+VOID
+FatTearDownDirentIndex (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees the dirent index of a directory, if it has one.  The
+    directory is searched linearly until another index is built.
+
+Arguments:
+
+    Dcb - Supplies the directory.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER( IrpContext );
+
+    if (Dcb->Specific.Dcb.DirentIndex != NULL) {
+
+        FatFreeDirentIndex( Dcb->Specific.Dcb.DirentIndex );
+        Dcb->Specific.Dcb.DirentIndex = NULL;
+    }
+}
+
+
 
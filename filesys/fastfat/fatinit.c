@@ -49,6 +49,16 @@ FatIsFujitsuFMR (
 #define COMPATIBILITY_MODE_KEY_NAME L"\\Registry\\Machine\\System\\CurrentControlSet\\Control\\FileSystem"
 #define COMPATIBILITY_MODE_VALUE_NAME L"Win31FileSystem"
 #define CODE_PAGE_INVARIANCE_VALUE_NAME L"FatDisableCodePageInvariance"
+#define EXTENT_CACHE_DEPTH_VALUE_NAME L"FatExtentCacheDepth"
+#define NONCACHED_QUEUE_DEPTH_VALUE_NAME L"FatNonCachedQueueDepth"
+
+//
+//  The default and largest number of closed files per volume kept in the
+//  extent cache.
+//
+
+#define FAT_DEFAULT_EXTENT_CACHE_DEPTH  16
+#define FAT_MAX_EXTENT_CACHE_DEPTH      256
 
 
 #define KEY_WORK_AREA ((sizeof(KEY_VALUE_FULL_INFORMATION) + \
@@ -364,6 +374,49 @@ Return Value:
         FatData.CodePageInvariant = TRUE;
     }
 
+    //
+    //  Read the registry to determine how many closed files per volume we
+    //  keep the allocation of in the extent cache.
+    //
+
+    ValueName.Buffer = EXTENT_CACHE_DEPTH_VALUE_NAME;
+    ValueName.Length = sizeof(EXTENT_CACHE_DEPTH_VALUE_NAME) - sizeof(WCHAR);
+    ValueName.MaximumLength = sizeof(EXTENT_CACHE_DEPTH_VALUE_NAME);
+
+    Status = FatGetCompatibilityModeValue( &ValueName, &Value );
+
+    if (NT_SUCCESS(Status)) {
+
+        FatData.ExtentCacheDepth = (Value > FAT_MAX_EXTENT_CACHE_DEPTH) ?
+                                   FAT_MAX_EXTENT_CACHE_DEPTH : Value;
+
+    } else {
+
+        FatData.ExtentCacheDepth = FAT_DEFAULT_EXTENT_CACHE_DEPTH;
+    }
+
+    //
+    //  Read the registry to see whether fragmented non-cached transfers
+    //  should be limited in how many runs they keep in flight.  Slow media
+    //  can do better working through the runs in order than being handed
+    //  all of them at once.
+    //
+
+    ValueName.Buffer = NONCACHED_QUEUE_DEPTH_VALUE_NAME;
+    ValueName.Length = sizeof(NONCACHED_QUEUE_DEPTH_VALUE_NAME) - sizeof(WCHAR);
+    ValueName.MaximumLength = sizeof(NONCACHED_QUEUE_DEPTH_VALUE_NAME);
+
+    Status = FatGetCompatibilityModeValue( &ValueName, &Value );
+
+    if (NT_SUCCESS(Status)) {
+
+        FatData.NonCachedQueueDepth = Value;
+
+    } else {
+
+        FatData.NonCachedQueueDepth = 0;
+    }
+
     //
     //  Initialize our global resource and fire up the lookaside lists.
     //
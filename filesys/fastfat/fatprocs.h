@@ -304,6 +304,23 @@ FatLookupFileAllocationSize (
     IN PFCB FcbOrDcb
     );
 
+VOID
+FatSaveFileExtents (
+    IN PIRP_CONTEXT IrpContext,
+    IN PFCB Fcb
+    );
+
+VOID
+FatLoadFileExtents (
+    IN PIRP_CONTEXT IrpContext,
+    IN PFCB Fcb
+    );
+
+VOID
+FatPurgeExtentCache (
+    IN PVCB Vcb
+    );
+
 _Requires_lock_held_(_Global_critical_region_)
 VOID
 FatAllocateDiskSpace (
@@ -702,6 +719,20 @@ FatLocateDirent (
     IN OUT PUNICODE_STRING OrigLfn OPTIONAL        
     );
 
+VOID
+FatNoteDirentsInIndex (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb,
+    IN VBO LfnOffset,
+    IN ULONG DirentCount
+    );
+
+VOID
+FatTearDownDirentIndex (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb
+    );
+
 _Requires_lock_held_(_Global_critical_region_)
 VOID
 FatLocateSimpleOemDirent (
@@ -1817,7 +1848,7 @@ FatRemoveNames (
 PFCB
 FatFindFcb (
     IN PIRP_CONTEXT IrpContext,
-    IN OUT PRTL_SPLAY_LINKS *RootNode,
+    IN PRTL_SPLAY_LINKS *RootNode,
     IN PSTRING Name,
     OUT PBOOLEAN FileNameDos OPTIONAL
     );
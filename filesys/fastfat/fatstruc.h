@@ -158,6 +158,20 @@ typedef struct _FAT_DATA {
 
     PVOID ZeroPage;
 
+    //
+    //  The number of closed files per volume whose decoded allocation we
+    //  keep in the volume's extent cache.  Zero disables the cache.
+    //
+
+    ULONG ExtentCacheDepth;
+
+    //
+    //  The most runs of a fragmented non-cached transfer we keep in flight
+    //  at once when the caller can wait.  Zero means no limit.
+    //
+
+    ULONG NonCachedQueueDepth;
+
 } FAT_DATA;
 typedef FAT_DATA *PFAT_DATA;
 
@@ -369,6 +383,18 @@ typedef struct _VCB {
 
     RTL_BITMAP FreeClusterBitMap;
 
+    //
+    //  FAT32 volumes with more than one window also keep a bitmap of the
+    //  whole volume, in which bit 0 is cluster 2.  It is filled in by the scan
+    //  of the FAT at mount or verify, and kept current as clusters are
+    //  reserved and freed.  It lets us find free runs of any size in a few
+    //  bitmap scans, and switch windows without reading the FAT again.  The
+    //  buffer is NULL if the volume has one window or the bitmap could not be
+    //  allocated.  It is protected by the FreeClusterBitMapMutex.
+    //
+
+    RTL_BITMAP VolumeClusterBitMap;
+
     //
     //  The following fast mutex controls access to the free cluster bit map
     //  and the buckets.
@@ -457,6 +483,17 @@ typedef struct _VCB {
 
     FAST_MUTEX DirectoryFileCreationMutex;
 
+    //
+    //  The following list holds the decoded allocation of recently closed
+    //  fragmented files, most recently used first, so that reopening one
+    //  does not mean walking its FAT chain again.  It is protected by the
+    //  ExtentCacheMutex.
+    //
+
+    LIST_ENTRY ExtentCacheList;
+    ULONG ExtentCacheCount;
+    FAST_MUTEX ExtentCacheMutex;
+
     //
     //  This field holds the thread address of the current (or most recent
     //  depending on VcbState) thread doing a verify operation on this volume.
@@ -946,6 +983,13 @@ typedef struct _FCB {
             __volatile ULONG DirectoryFileOpenCount;
             PFILE_OBJECT DirectoryFile;
 
+            //
+            //  Set once the directory file has been read ahead since its
+            //  cache map was initialized.  See FatReadDirectoryFile.
+            //
+
+            __volatile LONG DirectoryPrefetched;
+
 
             //
             //  If the UnusedDirentVbo is != 0xffffffff, then the dirent at this
@@ -1017,6 +1061,13 @@ typedef struct _FCB {
             PRTL_SPLAY_LINKS RootOemNode;
             PRTL_SPLAY_LINKS RootUnicodeNode;
 
+            //
+            //  Hashed name index, present only for large directories.
+            //  See FAT_DIRENT_INDEX.
+            //
+
+            struct _FAT_DIRENT_INDEX *DirentIndex;
+
             //
             //  The following field keeps track of free dirents, i.e.,
             //  dirents that are either unallocated for deleted.
@@ -1217,6 +1268,107 @@ typedef DCB *PDCB;
 
 #define FCB_LOOKUP_ALLOCATIONSIZE_HINT   ((LONGLONG) -1)
 
+
+//
+//  An extent cache entry records the Mcb runs of a closed file, keyed by
+//  the first cluster of the file.  The entry is taken back out of the
+//  cache when an Fcb is next created for the file, so no entry exists for
+//  a file while it has an Fcb and its allocation can change.
+//
+
+typedef struct _FAT_EXTENT {
+
+    VBO Vbo;
+    ULONG ByteCount;
+    LBO Lbo;
+
+} FAT_EXTENT;
+typedef FAT_EXTENT *PFAT_EXTENT;
+
+typedef struct _FAT_EXTENT_CACHE_ENTRY {
+
+    LIST_ENTRY Links;
+
+    ULONG FirstClusterOfFile;
+    ULONG RunCount;
+
+    FAT_EXTENT Runs[1];
+
+} FAT_EXTENT_CACHE_ENTRY;
+typedef FAT_EXTENT_CACHE_ENTRY *PFAT_EXTENT_CACHE_ENTRY;
+
+
+//
+//  A dirent index is a hash of the names in a large directory, built the
+//  first time a lookup has to walk a directory of FAT_DIRENT_INDEX_THRESHOLD
+//  or more dirents without finding its target.  Each entry records where a
+//  dirent set lives, hashed once by its upcased short name and once by its
+//  upcased long name, so that a later lookup only has to examine the few
+//  sets whose hash matches.
+//
+//  The index is a hint.  Every candidate is verified against the disk, so
+//  entries left behind by a failed operation only cost a wasted compare.
+//  Dirents created after the index was built are recorded in the pending
+//  list and hashed when the next lookup comes through, since the names are
+//  not yet on disk when the space for them is allocated.
+//
+
+#define FAT_DIRENT_INDEX_THRESHOLD       (1024)
+#define FAT_DIRENT_INDEX_MAX_PENDING     (32)
+#define FAT_DIRENT_INDEX_NIL             ((ULONG) -1)
+
+#define FAT_DIRENT_INDEX_SHORT           (0)
+#define FAT_DIRENT_INDEX_LONG            (1)
+
+typedef struct _FAT_DIRENT_INDEX_ENTRY {
+
+    //
+    //  Offset of the short dirent of the set, and the number of dirents
+    //  in the set including the short dirent.  A DirentCount of zero
+    //  marks a free entry.
+    //
+
+    VBO DirentOffset;
+    ULONG DirentCount;
+
+    //
+    //  Hash of the short and long name, and the next entry in each of the
+    //  corresponding hash chains.
+    //
+
+    ULONG Hash[2];
+    ULONG Next[2];
+
+} FAT_DIRENT_INDEX_ENTRY;
+typedef FAT_DIRENT_INDEX_ENTRY *PFAT_DIRENT_INDEX_ENTRY;
+
+typedef struct _FAT_DIRENT_INDEX {
+
+    ULONG BucketMask;
+    PULONG Buckets[2];
+
+    PFAT_DIRENT_INDEX_ENTRY Entries;
+    ULONG EntryCount;
+    ULONG EntryMax;
+    ULONG FreeEntry;
+
+    //
+    //  Dirent sets allocated since the index was built, identified by the
+    //  offset of their first dirent.
+    //
+
+    ULONG PendingCount;
+
+    struct {
+
+        VBO LfnOffset;
+        ULONG DirentCount;
+
+    } Pending[FAT_DIRENT_INDEX_MAX_PENDING];
+
+} FAT_DIRENT_INDEX;
+typedef FAT_DIRENT_INDEX *PFAT_DIRENT_INDEX;
+
 
 //
 //  The Ccb record is allocated for every file object.  Note that this
@@ -3685,6 +3685,16 @@ Return Value:
         Fcb->LfnOffsetWithinDirectory = NewOffset;
         Fcb->DirentOffsetWithinDirectory = ShortDirentOffset;
 
+        //
+        //  A rename in place didn't go through FatCreateNewDirent, so tell
+        //  the dirent index about the new name ourselves.
+        //
+
+        if (!DeleteSourceDirent) {
+
+            FatNoteDirentsInIndex( IrpContext, TargetDcb, NewOffset, DirentsRequired );
+        }
+
         RemoveEntryList( &Fcb->ParentDcbLinks );
 
         //
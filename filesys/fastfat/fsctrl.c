@@ -3488,6 +3488,16 @@ Return Value:
 
     IoReleaseVpbSpinLock( SavedIrql );
 
+    //
+    //  The holder of the lock may write to the FAT directly, so forget the
+    //  allocation of closed files.
+    //
+
+    if (NT_SUCCESS( Status )) {
+
+        FatPurgeExtentCache( Vcb );
+    }
+
     //
     //  If we successully locked the volume, see if it is clean now.
     //
@@ -5082,6 +5092,17 @@ Return Value:
                 RtlCopyMemory( &OutputBuffer->Buffer[0],
                                (PUCHAR)Vcb->FreeClusterBitMap.Buffer + StartingCluster/8,
                                BytesToCopy );
+
+            } else if (Vcb->VolumeClusterBitMap.Buffer != NULL) {
+
+                //
+                //  FAT32 with a bitmap of the whole volume, so we can copy
+                //  from that rather than read the FAT.
+                //
+
+                RtlCopyMemory( &OutputBuffer->Buffer[0],
+                               (PUCHAR)Vcb->VolumeClusterBitMap.Buffer + StartingCluster/8,
+                               BytesToCopy );
             } else {
 
                 //
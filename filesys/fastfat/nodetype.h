@@ -157,13 +157,16 @@ typedef CSHORT NODE_BYTE_SIZE;
 #define TAG_BCB                         'btaF'
 #define TAG_DIRENT                      'DtaF'
 #define TAG_DIRENT_BITMAP               'TtaF'
+#define TAG_DIRENT_INDEX                'HtaF'
 #define TAG_EA_DATA                     'dtaF'
 #define TAG_EA_SET_HEADER               'etaF'
 #define TAG_EVENT                       'ttaF'
 #define TAG_FAT_BITMAP                  'BtaF'
+#define TAG_FAT_VOLUME_BITMAP           'MtaF'
 #define TAG_FAT_CLOSE_CONTEXT           'xtaF'
 #define TAG_FAT_IO_CONTEXT              'XtaF'
 #define TAG_FAT_WINDOW                  'WtaF'
+#define TAG_FAT_EXTENT_CACHE            'KtaF'
 #define TAG_FILENAME_BUFFER             'ntaF'
 #define TAG_IO_RUNS                     'itaF'
 #define TAG_REPINNED_BCB                'RtaF'
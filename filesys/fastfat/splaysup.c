@@ -10,6 +10,12 @@ Abstract:
 
     This module implements the Fat Name lookup Suport routines
 
+    The names of the Fcbs below a directory are kept in binary trees
+    threaded through RTL_SPLAY_LINKS.  Despite the link type, the trees are
+    kept balanced as treaps, with a node priority derived from the address
+    of the node, so that looking a name up never changes the tree.  Only
+    inserting or removing a name needs the tree exclusive.
+
 
 --*/
 
@@ -32,8 +38,28 @@ Abstract:
 #pragma alloc_text(PAGE, FatRemoveNames)
 #pragma alloc_text(PAGE, FatFindFcb)
 #pragma alloc_text(PAGE, FatCompareNames)
+#pragma alloc_text(PAGE, FatDeleteName)
+#pragma alloc_text(PAGE, FatNamePriority)
+#pragma alloc_text(PAGE, FatRotateNameUp)
 #endif
 
+ULONG
+FatNamePriority (
+    IN PRTL_SPLAY_LINKS Links
+    );
+
+VOID
+FatRotateNameUp (
+    IN OUT PRTL_SPLAY_LINKS *RootNode,
+    IN PRTL_SPLAY_LINKS Links
+    );
+
+VOID
+FatDeleteName (
+    IN OUT PRTL_SPLAY_LINKS *RootNode,
+    IN PFILE_NAME_NODE Name
+    );
+
 
 VOID
 FatInsertName (
@@ -46,10 +72,9 @@ FatInsertName (
 
 Routine Description:
 
-    This routine will insert a name in the splay tree pointed to
-    by RootNode.
+    This routine will insert a name in the tree pointed to by RootNode.
 
-    The name must not already exist in the splay tree.
+    The name must not already exist in the tree.
 
 Arguments:
 
@@ -213,6 +238,17 @@ Restart:
         }
     }
 
+    //
+    //  Now lift the new node until its priority is no higher than that of
+    //  its parent, which is what keeps the tree balanced.
+    //
+
+    while (!RtlIsRoot( &Name->Links ) &&
+           (FatNamePriority( &Name->Links ) > FatNamePriority( RtlParent( &Name->Links )))) {
+
+        FatRotateNameUp( RootNode, &Name->Links );
+    }
+
     return;
 }
 
@@ -241,7 +277,6 @@ Return Value:
 
 {
     PDCB Parent;
-    PRTL_SPLAY_LINKS NewRoot;
 
     PAGED_CODE();
     UNREFERENCED_PARAMETER( IrpContext );
@@ -263,9 +298,7 @@ Return Value:
         //  Delete the node short name.
         //
 
-        NewRoot = RtlDelete(&Fcb->ShortName.Links);
-
-        Parent->Specific.Dcb.RootOemNode = NewRoot;
+        FatDeleteName( &Parent->Specific.Dcb.RootOemNode, &Fcb->ShortName );
 
         //
         //  Now check for the presence of long name and delete it.
@@ -273,9 +306,7 @@ Return Value:
 
         if (FlagOn( Fcb->FcbState, FCB_STATE_HAS_OEM_LONG_NAME )) {
 
-            NewRoot = RtlDelete(&Fcb->LongName.Oem.Links);
-
-            Parent->Specific.Dcb.RootOemNode = NewRoot;
+            FatDeleteName( &Parent->Specific.Dcb.RootOemNode, &Fcb->LongName.Oem );
 
             RtlFreeOemString( &Fcb->LongName.Oem.Name.Oem );
 
@@ -284,9 +315,7 @@ Return Value:
 
         if (FlagOn( Fcb->FcbState, FCB_STATE_HAS_UNICODE_LONG_NAME )) {
 
-            NewRoot = RtlDelete(&Fcb->LongName.Unicode.Links);
-
-            Parent->Specific.Dcb.RootUnicodeNode = NewRoot;
+            FatDeleteName( &Parent->Specific.Dcb.RootUnicodeNode, &Fcb->LongName.Unicode );
 
             RtlFreeUnicodeString( &Fcb->LongName.Unicode.Name.Unicode );
 
@@ -303,7 +332,7 @@ Return Value:
 PFCB
 FatFindFcb (
     IN PIRP_CONTEXT IrpContext,
-    IN OUT PRTL_SPLAY_LINKS *RootNode,
+    IN PRTL_SPLAY_LINKS *RootNode,
     IN PSTRING Name,
     OUT PBOOLEAN FileNameDos OPTIONAL
     )
@@ -312,9 +341,9 @@ FatFindFcb (
 
 Routine Description:
 
-    This routine searches either the Oem or Unicode splay tree looking
-    for an Fcb with the specified name.  In the case the Fcb is found,
-    rebalance the tree.
+    This routine searches either the Oem or Unicode tree looking for an
+    Fcb with the specified name.  The tree is not modified, so any number
+    of threads may search it at once.
 
 Arguments:
 
@@ -385,10 +414,6 @@ Return Value:
             //
             //  We found it.
             //
-            //  Splay the tree and save the new root.
-            //
-
-            *RootNode = RtlSplay(Links);
 
             //
             //  Tell the caller what kind of name we hit
@@ -484,3 +509,216 @@ Return Value:
     return IsEqual;
 }
 
+
+//
+//  Local support routine
+//
+
+ULONG
+FatNamePriority (
+    IN PRTL_SPLAY_LINKS Links
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the treap priority of a name node.  The priority
+    only has to be random with respect to the names, so it is derived from
+    the address of the node and costs us no space in the node.
+
+Arguments:
+
+    Links - Supplies the node.
+
+Return Value:
+
+    ULONG - The priority.
+
+--*/
+
+{
+    ULONG_PTR Address = (ULONG_PTR)Links;
+
+    PAGED_CODE();
+
+#if defined(_WIN64)
+    Address ^= Address >> 32;
+#endif
+
+    return (ULONG)(Address >> 3) * 0x9e3779b1;
+}
+
+
+//
+//  Local support routine
+//
+
+VOID
+FatRotateNameUp (
+    IN OUT PRTL_SPLAY_LINKS *RootNode,
+    IN PRTL_SPLAY_LINKS Links
+    )
+
+/*++
+
+Routine Description:
+
+    This routine rotates a node above its parent, preserving the order of
+    the tree.
+
+Arguments:
+
+    RootNode - Supplies a pointer to the root of the tree, updated if the
+        node becomes the root.
+
+    Links - Supplies the node to rotate, which must not be the root.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PRTL_SPLAY_LINKS Parent;
+    PRTL_SPLAY_LINKS GrandParent;
+
+    PAGED_CODE();
+
+    Parent = RtlParent( Links );
+    GrandParent = RtlParent( Parent );
+
+    NT_ASSERT( !RtlIsRoot( Links ));
+
+    if (RtlLeftChild( Parent ) == Links) {
+
+        Parent->LeftChild = Links->RightChild;
+
+        if (Links->RightChild != NULL) {
+
+            Links->RightChild->Parent = Parent;
+        }
+
+        Links->RightChild = Parent;
+
+    } else {
+
+        Parent->RightChild = Links->LeftChild;
+
+        if (Links->LeftChild != NULL) {
+
+            Links->LeftChild->Parent = Parent;
+        }
+
+        Links->LeftChild = Parent;
+    }
+
+    //
+    //  The root of a tree is its own parent.
+    //
+
+    if (GrandParent == Parent) {
+
+        Links->Parent = Links;
+        *RootNode = Links;
+
+    } else {
+
+        if (RtlLeftChild( GrandParent ) == Parent) {
+
+            GrandParent->LeftChild = Links;
+
+        } else {
+
+            GrandParent->RightChild = Links;
+        }
+
+        Links->Parent = GrandParent;
+    }
+
+    Parent->Parent = Links;
+}
+
+
+//
+//  Local support routine
+//
+
+VOID
+FatDeleteName (
+    IN OUT PRTL_SPLAY_LINKS *RootNode,
+    IN PFILE_NAME_NODE Name
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes a name from its tree.  The node is rotated down,
+    always lifting its higher priority child, until it has at most one
+    child and can simply be spliced out.
+
+Arguments:
+
+    RootNode - Supplies a pointer to the root of the tree.
+
+    Name - Supplies the name to remove.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PRTL_SPLAY_LINKS Links = &Name->Links;
+    PRTL_SPLAY_LINKS Parent;
+    PRTL_SPLAY_LINKS Child;
+
+    PAGED_CODE();
+
+    while ((Links->LeftChild != NULL) && (Links->RightChild != NULL)) {
+
+        if (FatNamePriority( Links->LeftChild ) > FatNamePriority( Links->RightChild )) {
+
+            FatRotateNameUp( RootNode, Links->LeftChild );
+
+        } else {
+
+            FatRotateNameUp( RootNode, Links->RightChild );
+        }
+    }
+
+    Child = (Links->LeftChild != NULL) ? Links->LeftChild : Links->RightChild;
+
+    if (RtlIsRoot( Links )) {
+
+        if (Child != NULL) {
+
+            Child->Parent = Child;
+        }
+
+        *RootNode = Child;
+
+    } else {
+
+        Parent = RtlParent( Links );
+
+        if (RtlLeftChild( Parent ) == Links) {
+
+            Parent->LeftChild = Child;
+
+        } else {
+
+            Parent->RightChild = Child;
+        }
+
+        if (Child != NULL) {
+
+            Child->Parent = Parent;
+        }
+    }
+
+    RtlInitializeSplayLinks( Links );
+}
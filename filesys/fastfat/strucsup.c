@@ -276,6 +276,13 @@ Return Value:
 
         FsRtlInitializeTunnelCache(&Vcb->Tunnel);
 
+        //
+        //  Initialize the extent cache
+        //
+
+        InitializeListHead( &Vcb->ExtentCacheList );
+        ExInitializeFastMutex( &Vcb->ExtentCacheMutex );
+
         //
         //  Insert this Vcb record on the FatData.VcbQueue
         //
@@ -873,6 +880,12 @@ Return Value:
         FatTearDownAllocationSupport( IrpContext, Vcb );
     }
 
+    //
+    //  Free anything left in the extent cache.
+    //
+
+    FatPurgeExtentCache( Vcb );
+
     //
     //  UnInitialize the Mcb structure that kept track of dirty fat sectors.
     //
@@ -1496,6 +1509,12 @@ Return Value:
         } else {
 
             Fcb->Header.AllocationSize.QuadPart = FCB_LOOKUP_ALLOCATIONSIZE_HINT;
+
+            //
+            //  If we recently closed this file, we may still know its allocation.
+            //
+
+            FatLoadFileExtents( IrpContext, Fcb );
         }
 
 
@@ -1972,6 +1991,8 @@ Return Value:
             ExFreePool(Fcb->Specific.Dcb.FreeDirentBitmap.Buffer);
         }
 
+        FatTearDownDirentIndex( IrpContext, Fcb );
+
 #if (NTDDI_VERSION >= NTDDI_WIN8)
         //
         //  Uninitialize the oplock.
@@ -1992,6 +2013,13 @@ Return Value:
 
         FsRtlUninitializeFileLock( &Fcb->Specific.Fcb.FileLock );
         FsRtlUninitializeOplock( FatGetFcbOplock(Fcb) );
+
+        //
+        //  Remember the allocation of fragmented files in case they are
+        //  opened again soon.
+        //
+
+        FatSaveFileExtents( IrpContext, Fcb );
     }
 
 
@@ -164,6 +164,17 @@ Return Value:
         FatResetFcb( IrpContext, Fcb );
     }
 
+    //
+    //  If the whole volume is in question, so is the allocation we remember
+    //  for closed files.
+    //
+
+    if ((FcbCondition != FcbGood) &&
+        (Fcb->Header.NodeTypeCode == FAT_NTC_ROOT_DCB)) {
+
+        FatPurgeExtentCache( Fcb->Vcb );
+    }
+
     //
     //  Now if we marked NeedsVerify or Bad a directory then we also need to
     //  go and mark all of our children with the same condition.
@@ -1533,6 +1544,12 @@ Return Value:
 
         Fcb->Specific.Dcb.UnusedDirentVbo = 0xffffffff;
         Fcb->Specific.Dcb.DeletedDirentHint = 0xffffffff;
+
+        //
+        //  And forget anything we knew about where its names are.
+        //
+
+        FatTearDownDirentIndex( IrpContext, Fcb );
     }
 }
 
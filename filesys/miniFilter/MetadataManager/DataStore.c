@@ -21,6 +21,27 @@ Environment:
 
 #include "pch.h"
 
+//
+//  Local function prototypes.
+//
+
+_Requires_lock_held_(_Global_critical_region_)
+_Requires_lock_held_(InstanceContext->MetadataResource)
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+FmmQueueMetadataReopen (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext
+    );
+
+FLT_GENERIC_WORKITEM_ROUTINE FmmReopenMetadataWorker;
+
+VOID
+FmmReopenMetadataWorker (
+    _In_ PFLT_GENERIC_WORKITEM FltWorkItem,
+    _In_ PVOID FltObject,
+    _In_opt_ PVOID Context
+    );
+
 //
 //  Assign text sections for each routine.
 //
@@ -31,6 +52,10 @@ Environment:
 #pragma alloc_text(PAGE, FmmReleaseMetadataFileReferences)
 #pragma alloc_text(PAGE, FmmReacquireMetadataFileReferences)
 #pragma alloc_text(PAGE, FmmSetMetadataOpenTriggerFileObject)
+#pragma alloc_text(PAGE, FmmReferenceMetadata)
+#pragma alloc_text(PAGE, FmmDereferenceMetadata)
+#pragma alloc_text(PAGE, FmmQueueMetadataReopen)
+#pragma alloc_text(PAGE, FmmReopenMetadataWorker)
 #pragma alloc_text(PAGE, FmmBeginFileSystemOperation)
 #pragma alloc_text(PAGE, FmmEndFileSystemOperation)
 #endif
@@ -363,6 +388,7 @@ FmmOpenMetadataCleanup:
 
         SetFlag( InstanceContext->Flags, INSTANCE_CONTEXT_F_METADATA_OPENED );
 
+        InstanceContext->MetadataGeneration++;
     }
 
     if (fileName.Buffer != NULL) {
@@ -661,8 +687,13 @@ Note:
         if (instanceContext->MetadataOpenTriggerFileObject == Cbd->Iopb->TargetFileObject) {
 
             //
-            //  Open the filter metadata file (do not read the file since we already have
-            //  stuff in memory and do not create if the file does not exist
+            //  Re-open the filter metadata file (do not read the file since we already have
+            //  stuff in memory and do not create if the file does not exist).
+            //
+            //  The open is done by a worker thread rather than on the thread that
+            //  unlocked the volume, so that volumes that are locked often, e.g. for
+            //  snapshots, do not make every unlock wait for it. Code that needs the 
+            //  metadata file before the worker runs opens it in FmmReferenceMetadata.
             //
 
             if (!FlagOn( instanceContext->Flags, INSTANCE_CONTEXT_F_METADATA_OPENED )) {
@@ -672,15 +703,14 @@ Note:
                              instanceContext,
                              Cbd->Iopb->TargetFileObject) );
 
-                status = FmmOpenMetadata( instanceContext,
-                                                 FALSE );
-
                 //
-                //  Reset the trigger file object since the volume open failed.
+                //  Reset the trigger file object since the volume is no longer locked.
                 //
 
                 instanceContext->MetadataOpenTriggerFileObject = NULL;
 
+                status = FmmQueueMetadataReopen( instanceContext );
+
             } else {
 
                 DebugTrace( DEBUG_TRACE_METADATA_OPERATIONS,
@@ -839,6 +869,334 @@ FmmSetMetadataOpenTriggerFileObjectCleanup:
     return status;;
 }
 
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+FmmReferenceMetadata (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext,
+    _Outptr_ PFILE_OBJECT *MetadataFileObject,
+    _Out_opt_ PULONG Generation
+    )
+/*++
+
+Routine Description:
+
+    This routine returns a referenced pointer to the metadata file object of
+    the instance, opening the metadata file first if it is not open yet, e.g.
+    because the worker re-opening it after an unlock has not run yet.
+
+    Any number of threads can hold references at the same time. A reference
+    keeps the file object valid but does not keep the metadata file open:
+    the handle is still closed when the volume is locked. Callers that keep
+    the file object compare InstanceContext->MetadataGeneration against the
+    returned generation to find out that the file was re-opened since.
+
+Arguments:
+
+    InstanceContext     - Supplies the instance context for this instance.
+    MetadataFileObject  - Receives the referenced metadata file object. The
+                          caller releases it with FmmDereferenceMetadata.
+    Generation          - Optionally receives the generation of the open.
+
+Return Value:
+
+    STATUS_SUCCESS if a reference was returned.
+    STATUS_FILE_LOCK_CONFLICT if the volume is locked or the instance context is 
+    in a transition state.
+    Otherwise the status of opening the metadata file.
+
+Note:
+
+    The caller must not hold the instance context resource when this routine 
+    is called.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    PAGED_CODE();
+
+    *MetadataFileObject = NULL;
+
+    //
+    //  Try the common case, where the file is open, under shared access
+    //
+
+    FmmAcquireResourceShared( &InstanceContext->MetadataResource );
+
+    if (!FlagOn( InstanceContext->Flags, INSTANCE_CONTEXT_F_TRANSITION ) &&
+        FlagOn( InstanceContext->Flags, INSTANCE_CONTEXT_F_METADATA_OPENED )) {
+
+        ObReferenceObject( InstanceContext->MetadataFileObject );
+        *MetadataFileObject = InstanceContext->MetadataFileObject;
+
+        if (Generation != NULL) {
+
+            *Generation = InstanceContext->MetadataGeneration;
+        }
+    }
+
+    FmmReleaseResource( &InstanceContext->MetadataResource );
+
+    if (*MetadataFileObject != NULL) {
+
+        return STATUS_SUCCESS;
+    }
+
+    //
+    //  Open the file under exclusive access
+    //
+
+    FmmAcquireResourceExclusive( &InstanceContext->MetadataResource );
+
+    if (FlagOn( InstanceContext->Flags, INSTANCE_CONTEXT_F_TRANSITION )) {
+
+        //
+        //  See FmmReleaseMetadataFileReferences for why we cannot touch the 
+        //  instance context in this state
+        //
+
+        status = STATUS_FILE_LOCK_CONFLICT;
+
+    } else if (!FlagOn( InstanceContext->Flags, INSTANCE_CONTEXT_F_METADATA_OPENED )) {
+
+        if (InstanceContext->MetadataOpenTriggerFileObject != NULL) {
+
+            //
+            //  The volume is locked or about to be removed, do not open the
+            //  file until it is unlocked
+            //
+
+            status = STATUS_FILE_LOCK_CONFLICT;
+
+        } else {
+
+            DebugTrace( DEBUG_TRACE_METADATA_OPERATIONS,
+                        ("[Fmm]: FmmReferenceMetadata -> Opening metadata file on first use (InstanceContext = %p)\n",
+                         InstanceContext) );
+
+            status = FmmOpenMetadata( InstanceContext,
+                                      FALSE );
+        }
+    }
+
+    if (NT_SUCCESS( status )) {
+
+        ObReferenceObject( InstanceContext->MetadataFileObject );
+        *MetadataFileObject = InstanceContext->MetadataFileObject;
+
+        if (Generation != NULL) {
+
+            *Generation = InstanceContext->MetadataGeneration;
+        }
+    }
+
+    FmmReleaseResource( &InstanceContext->MetadataResource );
+
+    if (!NT_SUCCESS( status )) {
+
+        DebugTrace( DEBUG_TRACE_ERROR | DEBUG_TRACE_METADATA_OPERATIONS,
+                    ("[Fmm]: FmmReferenceMetadata -> Failed to reference metadata file with status 0x%x (InstanceContext = %p)\n",
+                     status,
+                     InstanceContext) );
+    }
+
+    return status;
+}
+
+
+_IRQL_requires_max_(APC_LEVEL)
+VOID
+FmmDereferenceMetadata (
+    _In_ PFILE_OBJECT MetadataFileObject
+    )
+/*++
+
+Routine Description:
+
+    This routine releases a reference returned by FmmReferenceMetadata.
+
+Arguments:
+
+    MetadataFileObject  - Supplies the metadata file object.
+
+Return Value:
+
+    Void.
+
+--*/
+{
+    PAGED_CODE();
+
+    ObDereferenceObject( MetadataFileObject );
+}
+
+
+_Requires_lock_held_(_Global_critical_region_)
+_Requires_lock_held_(InstanceContext->MetadataResource)
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+FmmQueueMetadataReopen (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext
+    )
+/*++
+
+Routine Description:
+
+    This routine queues a work item to re-open the metadata file. If the 
+    work item cannot be queued the file is re-opened synchronously.
+
+Arguments:
+
+    InstanceContext     - Supplies the instance context for this instance.
+
+Return Value:
+
+    Returns the status of this operation.
+
+Note:
+
+    The caller must hold the instance context resource exclusive when this routine is called.
+
+--*/
+{
+    PFLT_GENERIC_WORKITEM workItem;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    if (InterlockedCompareExchange( &InstanceContext->ReopenPending, 1, 0 ) != 0) {
+
+        //
+        //  A worker is already on its way
+        //
+
+        return STATUS_SUCCESS;
+    }
+
+    workItem = FltAllocateGenericWorkItem();
+
+    if (workItem != NULL) {
+
+        //
+        //  The work item holds a reference to the instance context. Queueing
+        //  it against the instance keeps the instance from being torn down 
+        //  until the worker has run.
+        //
+
+        FltReferenceContext( InstanceContext );
+
+        status = FltQueueGenericWorkItem( workItem,
+                                          InstanceContext->Instance,
+                                          FmmReopenMetadataWorker,
+                                          DelayedWorkQueue,
+                                          InstanceContext );
+
+        if (NT_SUCCESS( status )) {
+
+            return STATUS_SUCCESS;
+        }
+
+        FltReleaseContext( InstanceContext );
+        FltFreeGenericWorkItem( workItem );
+    }
+
+    InterlockedExchange( &InstanceContext->ReopenPending, 0 );
+
+    DebugTrace( DEBUG_TRACE_METADATA_OPERATIONS,
+                ("[Fmm]: FmmQueueMetadataReopen -> Failed to queue work item, re-opening metadata file synchronously (InstanceContext = %p)\n",
+                 InstanceContext) );
+
+    return FmmOpenMetadata( InstanceContext,
+                            FALSE );
+}
+
+
+VOID
+FmmReopenMetadataWorker (
+    _In_ PFLT_GENERIC_WORKITEM FltWorkItem,
+    _In_ PVOID FltObject,
+    _In_opt_ PVOID Context
+    )
+/*++
+
+Routine Description:
+
+    This worker re-opens the metadata file queued by FmmQueueMetadataReopen,
+    unless the volume was locked again or the file was opened meanwhile.
+
+Arguments:
+
+    FltWorkItem         - Supplies the work item.
+    FltObject           - Supplies the instance.
+    Context             - Supplies the referenced instance context.
+
+Return Value:
+
+    Void.
+
+--*/
+{
+    PFMM_INSTANCE_CONTEXT instanceContext = (PFMM_INSTANCE_CONTEXT) Context;
+    NTSTATUS status;
+
+    UNREFERENCED_PARAMETER( FltObject );
+
+    PAGED_CODE();
+
+    FLT_ASSERT( instanceContext != NULL );
+    _Analysis_assume_( instanceContext != NULL );
+
+    FltFreeGenericWorkItem( FltWorkItem );
+
+    FmmAcquireResourceExclusive( &instanceContext->MetadataResource );
+
+    //
+    //  Once the flag is cleared a new unlock queues a new worker, so clear
+    //  it before looking at the state of the metadata file.
+    //
+
+    InterlockedExchange( &instanceContext->ReopenPending, 0 );
+
+    if (FlagOn( instanceContext->Flags, INSTANCE_CONTEXT_F_TRANSITION )) {
+
+        //
+        //  Another thread is using the instance context. Leave the open to
+        //  the first use of the metadata file.
+        //
+
+        DebugTrace( DEBUG_TRACE_METADATA_OPERATIONS,
+                    ("[Fmm]: FmmReopenMetadataWorker -> Instance context in transition, deferring re-open (InstanceContext = %p)\n",
+                     instanceContext) );
+
+    } else {
+
+        if (!FlagOn( instanceContext->Flags, INSTANCE_CONTEXT_F_METADATA_OPENED ) &&
+            (instanceContext->MetadataOpenTriggerFileObject == NULL)) {
+
+            status = FmmOpenMetadata( instanceContext,
+                                      FALSE );
+
+            if (!NT_SUCCESS( status )) {
+
+                //
+                //  The volume may have been dismounted after the unlock, see
+                //  FmmPostCleanup. The next use of the file will retry.
+                //
+
+                DebugTrace( DEBUG_TRACE_ERROR | DEBUG_TRACE_METADATA_OPERATIONS,
+                            ("[Fmm]: FmmReopenMetadataWorker -> Failed to re-open metadata with status 0x%x (InstanceContext = %p)\n",
+                             status,
+                             instanceContext) );
+            }
+        }
+    }
+
+    FmmReleaseResource( &instanceContext->MetadataResource );
+
+    FltReleaseContext( instanceContext );
+}
+
 _Releases_lock_(_Global_critical_region_)
 _Requires_lock_held_(InstanceContext->MetadataResource)
 _Releases_lock_(InstanceContext->MetadataResource)
@@ -1039,7 +1397,8 @@ Note:
         //  Return if the metadata is opened
         //
 
-        *MetadataOpen = BooleanFlagOn( instanceContext->Flags, INSTANCE_CONTEXT_F_METADATA_OPENED );
+        *MetadataOpen = BooleanFlagOn( instanceContext->Flags, INSTANCE_CONTEXT_F_METADATA_OPENED ) ||
+                        (instanceContext->ReopenPending != 0);
 
         //
         //  Sanity - verify that this flag is reflecting the correct state of the metadata file
@@ -144,6 +144,20 @@ FmmSetMetadataOpenTriggerFileObject (
     _Inout_ PFLT_CALLBACK_DATA Cbd
     );
 
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+FmmReferenceMetadata (
+    _In_ PFMM_INSTANCE_CONTEXT InstanceContext,
+    _Outptr_ PFILE_OBJECT *MetadataFileObject,
+    _Out_opt_ PULONG Generation
+    );
+
+_IRQL_requires_max_(APC_LEVEL)
+VOID
+FmmDereferenceMetadata (
+    _In_ PFILE_OBJECT MetadataFileObject
+    );
+
 _Releases_lock_(_Global_critical_region_)
 _Requires_lock_held_(InstanceContext->MetadataResource)
 _Releases_lock_(InstanceContext->MetadataResource)
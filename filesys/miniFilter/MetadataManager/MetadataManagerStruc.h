@@ -141,6 +141,24 @@ typedef struct _FMM_INSTANCE_CONTEXT {
 
     PFILE_OBJECT MetadataOpenTriggerFileObject;
 
+    //
+    //  Incremented every time the metadata file is opened. Code that caches
+    //  a reference to MetadataFileObject obtained from FmmReferenceMetadata
+    //  compares this against the generation it was handed to find out that
+    //  the file has since been closed and re-opened.
+    //
+
+    ULONG MetadataGeneration;
+
+    //
+    //  Non-zero while a work item is queued to re-open the metadata file
+    //  after the volume was unlocked or its removal was cancelled. This is
+    //  updated with interlocked operations rather than kept in Flags so that
+    //  the worker can give it up while the context is in a transition state.
+    //
+
+    volatile LONG ReopenPending;
+
 } FMM_INSTANCE_CONTEXT, *PFMM_INSTANCE_CONTEXT;
 
 #define FMM_INSTANCE_CONTEXT_SIZE         sizeof( FMM_INSTANCE_CONTEXT )
@@ -150,6 +150,10 @@ typedef struct __NC_CACHE_ENTRY {
 //  various paths for the mapping for easy comparison.  We do not use
 //  this structure for user-supplied paths (eg. on open.)
 //
+//  The upcased strings live in the second half of the FullPath allocation
+//  so that case insensitive comparisons only need to upcase the name being
+//  compared, not the mapping, on every operation.
+//
 
 typedef struct _NC_MAPPING_PATH {
 
@@ -158,6 +162,8 @@ typedef struct _NC_MAPPING_PATH {
     UNICODE_STRING ParentPath;            // \volume_name\parent_name
     UNICODE_STRING FinalComponentName;    // final_component or \ (for volume root open)
     UNICODE_STRING VolumelessName;        // \parent_name\final_component
+    UNICODE_STRING UpcaseFullPath;        // FullPath, upcased
+    UNICODE_STRING UpcaseVolumelessName;  // VolumelessName, upcased
     USHORT NumberComponentsInFullPath;    // \volume_name\parent_name\final_component == 3
     USHORT NumberComponentsInVolumePath;  // \volume_name == 1
 
@@ -766,8 +766,13 @@ Return Value:
         CacheString.Length = (USHORT) NcGetFileNameLength( CacheEntry, Offsets );
         CacheString.MaximumLength = CacheString.Length;
 
+        //
+        //  Most entries in a large directory differ from the mapping in
+        //  length, so check that before doing the full string compare.
+        //
 
-        if (RtlCompareUnicodeString( &CacheString, 
+        if (CacheString.Length == IgnoreString->Length &&
+            RtlCompareUnicodeString( &CacheString, 
                                      IgnoreString,
                                      IgnoreCase ) == 0) {
 
@@ -124,6 +124,20 @@ NcIsMappingPathZeroed(
         return FALSE;
     }
 
+    if (Path->UpcaseFullPath.Buffer != NULL ||
+        Path->UpcaseFullPath.Length != 0 ||
+        Path->UpcaseFullPath.MaximumLength != 0) {
+
+        return FALSE;
+    }
+
+    if (Path->UpcaseVolumelessName.Buffer != NULL ||
+        Path->UpcaseVolumelessName.Length != 0 ||
+        Path->UpcaseVolumelessName.MaximumLength != 0) {
+
+        return FALSE;
+    }
+
     return TRUE;
 }
 
@@ -252,13 +266,14 @@ Return Value:
     }
 
     //
-    //  Allocate Buffer for Name.
+    //  Allocate Buffer for Name.  The buffer is twice the length of the
+    //  name; the second half holds the upcased copy of the name.
     //
 
     NameLength = VolumeName->Length + ParentPath->Length + SeparatorLength + FinalComponent->Length;
 
     NameBuffer = ExAllocatePoolWithTag( PagedPool,
-                                        NameLength,
+                                        (ULONG)NameLength * 2,
                                         NC_MAPPING_TAG );
 
     if (NameBuffer == NULL) {
@@ -334,6 +349,29 @@ Return Value:
     Path->VolumelessName.Length = NameString.Length - VolumeName->Length;
     Path->VolumelessName.MaximumLength = Path->VolumelessName.Length;
 
+    //
+    //  Build the upcased copies used for case insensitive comparison.
+    //
+
+    Path->UpcaseFullPath.Buffer = (PWSTR)Add2Ptr( NameString.Buffer, NameLength );
+    Path->UpcaseFullPath.Length = 0;
+    Path->UpcaseFullPath.MaximumLength = NameLength;
+
+    Status = RtlUpcaseUnicodeString( &Path->UpcaseFullPath,
+                                     &Path->FullPath,
+                                     FALSE );
+
+    if (!NT_SUCCESS( Status )) {
+
+        goto NcBuildMappingPathCleanup;
+    }
+
+    FLT_ASSERT( Path->UpcaseFullPath.Length == Path->FullPath.Length );
+
+    Path->UpcaseVolumelessName.Buffer = (PWSTR)Add2Ptr( Path->UpcaseFullPath.Buffer, VolumeName->Length );
+    Path->UpcaseVolumelessName.Length = Path->VolumelessName.Length;
+    Path->UpcaseVolumelessName.MaximumLength = Path->VolumelessName.Length;
+
     Path->NumberComponentsInVolumePath = 0;
 
     for (Index = 0; Index < Path->VolumePath.Length/sizeof(WCHAR); Index++) {
@@ -87,15 +87,25 @@ Return Value:
 
     PAGED_CODE();
 
+    //
+    //  For case insensitive comparisons we compare against the upcased
+    //  copies of the mapping built by NcBuildMappingPath, so only the
+    //  characters of the name need to be upcased.
+    //
+
     if (ContainsDevice) {
-        LongName = &Mapping->LongNamePath.FullPath;
-        ShortName = &Mapping->ShortNamePath.FullPath;
+        LongName = IgnoreCase ? &Mapping->LongNamePath.UpcaseFullPath :
+                                &Mapping->LongNamePath.FullPath;
+        ShortName = IgnoreCase ? &Mapping->ShortNamePath.UpcaseFullPath :
+                                 &Mapping->ShortNamePath.FullPath;
 
         MappingComponents = Mapping->LongNamePath.NumberComponentsInFullPath;
         VolumeComponents = Mapping->LongNamePath.NumberComponentsInVolumePath;
     } else {
-        LongName = &Mapping->LongNamePath.VolumelessName;
-        ShortName = &Mapping->ShortNamePath.VolumelessName;
+        LongName = IgnoreCase ? &Mapping->LongNamePath.UpcaseVolumelessName :
+                                &Mapping->LongNamePath.VolumelessName;
+        ShortName = IgnoreCase ? &Mapping->ShortNamePath.UpcaseVolumelessName :
+                                 &Mapping->ShortNamePath.VolumelessName;
 
         MappingComponents = Mapping->LongNamePath.NumberComponentsInFullPath - Mapping->LongNamePath.NumberComponentsInVolumePath;
         VolumeComponents = 0;
@@ -179,29 +189,24 @@ Return Value:
 
             //
             //  Convert characters into case insensitive mode (if needed)
+            //  The mapping strings are already upcased in that case.
             //
 
             if (IgnoreCase) {
 
                 NameBuffCur = RtlUpcaseUnicodeChar( NameBuff[NameIndex] );
-                if (!LongDone) {
-                    LongBuffCur = RtlUpcaseUnicodeChar( LongBuff[LongIndex] );
-                }
-
-                if (!ShortDone) {
-                    ShortBuffCur = RtlUpcaseUnicodeChar( ShortBuff[ShortIndex] );
-                }
 
             } else {
 
                 NameBuffCur = NameBuff[NameIndex];
-                if (!LongDone) {
-                    LongBuffCur = LongBuff[LongIndex];
-                }
+            }
 
-                if (!ShortDone) {
-                    ShortBuffCur = ShortBuff[ShortIndex];
-                }
+            if (!LongDone) {
+                LongBuffCur = LongBuff[LongIndex];
+            }
+
+            if (!ShortDone) {
+                ShortBuffCur = ShortBuff[ShortIndex];
             }
 
             //
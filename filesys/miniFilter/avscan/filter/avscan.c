@@ -150,6 +150,7 @@ AvProcessTransactionOutcome (
 NTSTATUS
 AvLoadFileStateFromCache (
     _In_ PFLT_INSTANCE Instance,
+    _In_ PFILE_OBJECT FileObject,
     _In_ PAV_FILE_REFERENCE FileId,
     _Out_ LONG volatile* State,
     _Out_ PLONGLONG VolumeRevision,
@@ -160,6 +161,7 @@ AvLoadFileStateFromCache (
 NTSTATUS
 AvSyncCache (
     _In_     PFLT_INSTANCE      Instance,
+    _In_     PFILE_OBJECT       FileObject,
     _In_     PAV_STREAM_CONTEXT   StreamContext
     );
 
@@ -388,32 +390,12 @@ Return Value:
     instanceContext->IsOnCsvMDS = isOnCsv;
     
     //
-    //  There will be a file state cache table for each NTFS volume instance.
-    //  As for other file systems, file id is not unique, and thus we do 
-    //  not have cache for other kinds of file systems. Since the cache 
-    //  table is not mandatory to implement an anti-virus filter, we 
-    //  only have the volatile cache for NTFS, CSVFS and REFS.
+    //  Files on NTFS, CSVFS and REFS volumes are kept in the file state
+    //  cache, keyed by volume and file ID. As for other file systems, file
+    //  id is not unique, and thus we do not cache them. Since the cache
+    //  is not mandatory to implement an anti-virus filter, we only have
+    //  the volatile cache for NTFS, CSVFS and REFS.
     //
-    //  It is worth mentioning that the table is potentially very large. 
-    //  We use an AVL tree to improve insertion and query times. We do not 
-    //  set an upper bound for the size of the tree which is not optimal. 
-    //  Consider limiting the size of the tree for a production filter.
-    //
-    
-    if (FS_SUPPORTS_FILE_STATE_CACHE( VolumeFilesystemType )) {
-    
-        //
-        //  Initialize file state cache in the instance context.
-        //
-
-        ExInitializeResourceLite( &instanceContext->Resource );
-        
-        RtlInitializeGenericTable( &instanceContext->FileStateCacheTable,
-                                   (PRTL_GENERIC_COMPARE_ROUTINE) AvCompareEntry,
-                                   (PRTL_GENERIC_ALLOCATE_ROUTINE) AvAllocateGenericTableEntry,
-                                   (PRTL_GENERIC_FREE_ROUTINE) AvFreeGenericTableEntry,
-                                   NULL );                                
-    }
 
     status = FltSetInstanceContext( FltObjects->Instance,
                                     FLT_SET_CONTEXT_KEEP_IF_EXISTS,
@@ -581,24 +563,12 @@ Return Value:
     AvReleaseResource( &Globals.ScanCtxListLock );
     
     //
-    //  Clean up the cache table if the volume supports one.
+    //  Remove the files of this volume from the file state cache.
     //
     
     if (FS_SUPPORTS_FILE_STATE_CACHE( instanceContext->VolumeFSType )) {
-        PAV_GENERIC_TABLE_ENTRY entry = NULL;
-        AvAcquireResourceExclusive( &instanceContext->Resource );
-            
-        while (!RtlIsGenericTableEmpty( &instanceContext->FileStateCacheTable ) ) {
-            entry = RtlGetElementGenericTable(&instanceContext->FileStateCacheTable, 0);
-            AV_DBG_PRINT( AVDBG_TRACE_ROUTINES,
-                  ("[AV] AvInstanceTeardownStart: %I64x,%I64x requesting deletion, state:%d\n", 
-                        entry->FileId.FileId64.UpperZeroes,
-                        entry->FileId.FileId64.Value,
-                        entry->InfectedState) );
-            RtlDeleteElementGenericTable(&instanceContext->FileStateCacheTable, entry);
-        }
-        
-        AvReleaseResource( &instanceContext->Resource );
+
+        AvCachePurgeVolume( instanceContext->Volume );
     }
     
     FltReleaseContext( instanceContext );
@@ -712,6 +682,20 @@ Return Value:
             leave;
         }        
 
+        //
+        //  Allocate the file state cache
+        //
+
+        status = AvCacheInitialize();
+
+        if (!NT_SUCCESS( status )) {
+
+            AV_DBG_PRINT( AVDBG_TRACE_ERROR,
+                         ("[AV]: DriverEntry: AvCacheInitialize FAILED. status = 0x%x\n", status) );
+
+            leave;
+        }
+
         //
         //  Register with FltMgr to tell it our callback routines
         //
@@ -812,6 +796,8 @@ Return Value:
                 Globals.Filter = NULL;
             }
 
+            AvCacheFinalize();
+
             ExDeleteResourceLite( &Globals.ScanCtxListLock );           
         }        
     }
@@ -872,6 +858,8 @@ Return Value:
     Globals.QueryServerPort = NULL;
     FltUnregisterFilter( Globals.Filter );  // This will typically trigger instance tear down.
     Globals.Filter = NULL;
+
+    AvCacheFinalize();
     
     ExDeleteResourceLite( &Globals.ScanCtxListLock );
 
@@ -1141,6 +1129,7 @@ Return Value:
 NTSTATUS
 AvLoadFileStateFromCache (
     _In_ PFLT_INSTANCE Instance,
+    _In_ PFILE_OBJECT FileObject,
     _In_ PAV_FILE_REFERENCE FileId,
     _Out_ LONG volatile *State,
     _Out_ PLONGLONG VolumeRevision,
@@ -1153,10 +1142,16 @@ Routine Description:
 
     This routine lookups the file state in the cache table. 
 
+    The cached state is only used if the update sequence number of the
+    file has not changed since it was cached, which catches modifications
+    we did not see, for example while our instance was not attached.
+
 Arguments:
 
     Instance - Opaque filter pointer for the caller. This parameter is required and cannot be NULL.
     
+    FileObject - File object pointer for the file. This parameter is required and cannot be NULL.
+
     FileID - The ID to lookup in the cache
     
     State - The cached state for the file
@@ -1169,8 +1164,8 @@ Return Value:
 {
     NTSTATUS status = STATUS_SUCCESS;
     PAV_INSTANCE_CONTEXT instanceContext = NULL;
-    AV_GENERIC_TABLE_ENTRY query = {0};
-    PAV_GENERIC_TABLE_ENTRY entry = NULL;
+    AV_CACHE_ENTRY entry = {0};
+    USN usn;
     
     PAGED_CODE();
 
@@ -1195,23 +1190,39 @@ Return Value:
         goto Cleanup;
     }
 
-    RtlCopyMemory( &query.FileId, FileId, sizeof(query.FileId) ); 
-    
-    AvAcquireResourceShared( &instanceContext->Resource );
+    if (!AvCacheLookup( instanceContext->Volume, FileId, &entry )) {
+
+        status = STATUS_NOT_FOUND;
+        goto Cleanup;
+    }
 
-    entry = RtlLookupElementGenericTable( &instanceContext->FileStateCacheTable,
-                                          &query );
+    //
+    //  Only pay for reading the USN when there is something to validate.
+    //
 
-    if (entry != NULL) {
-        *State = entry->InfectedState;
-        *VolumeRevision = entry->VolumeRevision;
-        *CacheRevision = entry->CacheRevision;
-        *FileRevision = entry->FileRevision;
-    } else {
+    if (!NT_SUCCESS( AvGetFileUsn( Instance, FileObject, &usn ) )) {
+
+        usn = 0;
+    }
+
+    if (usn != entry.Usn) {
+
+        AV_DBG_PRINT( AVDBG_TRACE_ROUTINES,
+              ("[AV] AvLoadFileStateFromCache: %I64x,%I64x is stale, usn %I64x cached %I64x\n",
+                    FileId->FileId64.UpperZeroes,
+                    FileId->FileId64.Value,
+                    usn,
+                    entry.Usn) );
+
+        AvCacheInvalidate( instanceContext->Volume, FileId, TRUE );
         status = STATUS_NOT_FOUND;
+        goto Cleanup;
     }
 
-    AvReleaseResource( &instanceContext->Resource );
+    *State = entry.InfectedState;
+    *VolumeRevision = entry.VolumeRevision;
+    *CacheRevision = entry.CacheRevision;
+    *FileRevision = entry.FileRevision;
 
 Cleanup:
 
@@ -1222,6 +1233,7 @@ Cleanup:
 NTSTATUS
 AvSyncCache (
     _In_ PFLT_INSTANCE Instance,
+    _In_ PFILE_OBJECT FileObject,
     _In_ PAV_STREAM_CONTEXT StreamContext
     )
 /*++
@@ -1235,6 +1247,8 @@ Arguments:
 
     Instance - Opaque filter pointer for the caller. This parameter is required and cannot be NULL.
     
+    FileObject - File object pointer for the file. This parameter is required and cannot be NULL.
+
     StreamContext - The stream context of the target file.
     
 Return Value:
@@ -1244,9 +1258,7 @@ Return Value:
 --*/
 {
     NTSTATUS  status = STATUS_SUCCESS;
-    BOOLEAN   inserted = FALSE;
-    AV_GENERIC_TABLE_ENTRY entry = {0};
-    PAV_GENERIC_TABLE_ENTRY pEntry = NULL;
+    AV_CACHE_ENTRY entry = {0};
     PAV_INSTANCE_CONTEXT   instanceContext = NULL;
 
     PAGED_CODE();
@@ -1286,43 +1298,30 @@ Return Value:
     //  If the file system is NTFS, CSVFS or REFS, overwrite the entry in the
     //  cache table if exists
     //
-    
-    RtlCopyMemory( &entry.FileId, &StreamContext->FileId, sizeof(entry.FileId) );
-
-    AvAcquireResourceExclusive( &instanceContext->Resource );
-
-    pEntry = RtlInsertElementGenericTable( &instanceContext->FileStateCacheTable,
-                                          (PVOID) &entry,
-                                          AV_GENERIC_TABLE_ENTRY_SIZE,
-                                          &inserted);
-    if (pEntry) {
+    //  Note the cache may become stale as files are modified.
+    //
 
-        //
-        //  Note the cache may become stale as files are modified.
-        //
+    //
+    //  It is possible that after building the entry below, thread A
+    //  modifies the file, and before thread A closes the handle, thread B
+    //  opens the same file. This is fine because in such a case, the
+    //  streamcontext exists and AvPostCreate uses the state in stream
+    //  context. Thus, thread B will need to scan the file.
+    //
 
-        //
-        //  It is possible that after entering the following else-if 
-        //  branch, thread A modifies the file, and before thread A 
-        //  closes the handle, thread B opens the same file. This 
-        //  is fine because in such a case, the streamcontext exists
-        //  AvLoadFileStateFromCache would return the state in stream
-        //  context. Thus, thread B will need to scan the file.
-        //
+    entry.Volume = instanceContext->Volume;
+    RtlCopyMemory( &entry.FileId, &StreamContext->FileId, sizeof(entry.FileId) );
+    entry.InfectedState = StreamContext->State;
+    entry.VolumeRevision = StreamContext->VolumeRevision;
+    entry.CacheRevision = StreamContext->CacheRevision;
+    entry.FileRevision = StreamContext->FileRevision;
 
-        pEntry->InfectedState = StreamContext->State;
-        pEntry->VolumeRevision = StreamContext->VolumeRevision;
-        pEntry->CacheRevision = StreamContext->CacheRevision;
-        pEntry->FileRevision = StreamContext->FileRevision;
+    if (!NT_SUCCESS( AvGetFileUsn( Instance, FileObject, &entry.Usn ) )) {
 
+        entry.Usn = 0;
     }
 
-    AvReleaseResource( &instanceContext->Resource );
-
-    if (!pEntry) {
-        AV_DBG_PRINT( AVDBG_TRACE_ERROR,
-              ("[AV] AvSyncCache: RtlInsertElementGenericTable failed.\n") );
-    }
+    AvCacheUpdate( &entry );
 
 Cleanup:
 
@@ -1485,6 +1484,8 @@ Return Value:
     LONGLONG fileSize;
     FLT_VOLUME_PROPERTIES volumeProperties;
     ULONG volumePropertiesLength;
+    ULONG rangeCount = 0;
+    AV_SCAN_RANGE ranges[AV_SCAN_RANGE_MAX];
     
     PAGED_CODE();
     
@@ -1531,6 +1532,17 @@ Return Value:
         //
 
         if (IS_FILE_NEED_SCAN( StreamContext )){
+
+            //
+            //  If the file was clean before it was written, only the written 
+            //  ranges have to be scanned. The transacted writer's view is 
+            //  always scanned in full.
+            //
+
+            if (!IsInTxWriter) {
+
+                AvCaptureDirtyRanges( StreamContext, &rangeCount, ranges );
+            }
             
             if (ScanMode == AvUserMode) {
 
@@ -1554,7 +1566,9 @@ Return Value:
                                        FltObjects,
                                        IOMajorFunctionAtScan,
                                        IsInTxWriter,
-                                       volumeProperties.DeviceType );
+                                       volumeProperties.DeviceType,
+                                       rangeCount,
+                                       ranges );
                             
                 if (!NT_SUCCESS( status ) || status == STATUS_TIMEOUT) {
 
@@ -1567,7 +1581,9 @@ Return Value:
                 status = AvScanInKernel( FltObjects, 
                                          IOMajorFunctionAtScan,
                                          IsInTxWriter,
-                                         StreamContext );
+                                         StreamContext,
+                                         rangeCount,
+                                         ranges );
                
                 if (!NT_SUCCESS( status )) {
                 
@@ -1576,6 +1592,16 @@ Return Value:
                 }
 
             }
+
+            //
+            //  The captured ranges were not scanned, so the next scan has
+            //  to cover the whole file.
+            //
+
+            if (!NT_SUCCESS( status ) || status == STATUS_TIMEOUT) {
+
+                AvInvalidateDirtyRanges( StreamContext );
+            }
             
         }
 
@@ -1884,9 +1910,30 @@ Return Value:
         //  because the file is part of a transaction writer
         //
         
+        AvInvalidateDirtyRanges( streamContext );
         SET_FILE_TX_MODIFIED( streamContext );
         
     } else {
+
+        //
+        //  Remember what a write touches so that the next scan can be 
+        //  limited to it. The range must be recorded before the state 
+        //  changes: a scan that finds the file clean relies on it to tell 
+        //  whether it raced with this write. Anything else that modifies 
+        //  the file is not tracked and forces a scan of the whole file.
+        //
+
+        if ((Data->Iopb->MajorFunction == IRP_MJ_WRITE) &&
+            (Data->Iopb->Parameters.Write.ByteOffset.HighPart != -1)) {
+
+            AvAddDirtyRange( streamContext,
+                             Data->Iopb->Parameters.Write.ByteOffset.QuadPart,
+                             Data->Iopb->Parameters.Write.Length );
+
+        } else {
+
+            AvInvalidateDirtyRanges( streamContext );
+        }
     
         //
         //  Consider an optimization for the case where another thread
@@ -1895,6 +1942,17 @@ Return Value:
         
         SET_FILE_MODIFIED( streamContext );
     }
+
+    //
+    //  The cached state no longer describes the file. Drop it now: if the
+    //  file is still modified when it is closed, AvPreCleanup does not
+    //  update the cache, and a later open would be given the old state.
+    //
+
+    if (!AV_INVALID_FILE_REFERENCE( streamContext->FileId )) {
+
+        AvCacheInvalidate( FltObjects->Volume, &streamContext->FileId, FALSE );
+    }
     
     FltReleaseContext( streamContext );
 
@@ -2512,11 +2570,23 @@ Return Value:
             //
 
             AvLoadFileStateFromCache( FltObjects->Instance, 
+                                      FltObjects->FileObject,
                                       &streamContext->FileId,
                                       &streamContext->State,
                                       &streamContext->VolumeRevision,
                                       &streamContext->CacheRevision,
                                       &streamContext->FileRevision );            
+
+            //
+            //  A file known to be clean only needs what is written to it 
+            //  from now on scanned. The context is not visible to anyone 
+            //  else yet, so there is no need for the lock.
+            //
+
+            if (IS_FILE_NOT_INFECTED( streamContext )) {
+
+                streamContext->DirtyRangesWhole = FALSE;
+            }
         }
         
         //
@@ -2873,7 +2943,7 @@ Cleanup:
     if (!IS_FILE_MODIFIED( streamContext ) || 
         IS_FILE_INFECTED( streamContext )) {
 
-        if (!NT_SUCCESS ( AvSyncCache( FltObjects->Instance, streamContext ))) {
+        if (!NT_SUCCESS ( AvSyncCache( FltObjects->Instance, FltObjects->FileObject, streamContext ))) {
 
             AV_DBG_PRINT( AVDBG_TRACE_ERROR,
                       ("[AV] AvPreCleanup: AvSyncCache FAILED!! \n") );
@@ -30,10 +30,11 @@ Environment:
 #include <dontuse.h>
 #include <suppress.h>
 #include "utility.h"
+#include "avlib.h"
 #include "context.h"
 #include "scan.h"
 #include "csvfs.h"
-#include "avlib.h"
+#include "cache.h"
 
 
 #pragma prefast(disable:__WARNING_ENCODE_MEMBER_FUNCTION_POINTER, "Not valid for kernel mode drivers")
@@ -132,6 +133,12 @@ typedef struct _AV_SCANNER_GLOBAL_DATA {
     
     LONGLONG NetworkScanTimeout;
 
+    //
+    //  The file state cache shared by all instances.
+    //
+
+    AV_CACHE Cache;
+
 #if DBG
 
     //
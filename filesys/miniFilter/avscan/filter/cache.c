@@ -0,0 +1,584 @@
+/*++
+
+Copyright (c) 2011  Microsoft Corporation
+
+Module Name:
+
+    cache.c
+
+Abstract:
+
+    This is the file state cache module of the avscan mini-filter driver.
+    The cache remembers the scan result of files that were closed so that
+    re-opening them does not cause a rescan. Please see cache.h for how
+    it is organized.
+
+Environment:
+
+    Kernel mode
+
+--*/
+
+#include "avscan.h"
+
+/*************************************************************************
+    Local Function Prototypes
+*************************************************************************/
+
+PAV_CACHE_BUCKET
+AvCacheGetBucket (
+    _In_ PFLT_VOLUME Volume,
+    _In_ PAV_FILE_REFERENCE FileId
+    );
+
+PAV_CACHE_ENTRY
+AvCacheFindEntry (
+    _In_ PAV_CACHE_BUCKET Bucket,
+    _In_ PFLT_VOLUME Volume,
+    _In_ PAV_FILE_REFERENCE FileId
+    );
+
+BOOLEAN
+AvCacheReadEntry (
+    _In_ PAV_CACHE_BUCKET Bucket,
+    _In_ PFLT_VOLUME Volume,
+    _In_ PAV_FILE_REFERENCE FileId,
+    _Out_ PAV_CACHE_ENTRY Entry
+    );
+
+//
+//  Assign text sections for each routine.
+//
+
+#ifdef  ALLOC_PRAGMA
+#pragma alloc_text(INIT, AvCacheInitialize)
+#pragma alloc_text(PAGE, AvCacheFinalize)
+#pragma alloc_text(PAGE, AvCacheQueryStatistics)
+#endif
+
+#define AV_CACHE_FILE_ID_EQUAL( _a_, _b_ ) \
+    (((_a_).FileId64.Value == (_b_).FileId64.Value) && \
+     ((_a_).FileId64.UpperZeroes == (_b_).FileId64.UpperZeroes))
+
+#define AV_CACHE_COUNT( _counter_ ) \
+    InterlockedIncrement64( &Globals.Cache.Counters[KeGetCurrentProcessorIndex() % AV_CACHE_COUNTER_SLOTS]._counter_ )
+
+FORCEINLINE
+VOID
+AvCacheLockBucket (
+    _Inout_ PAV_CACHE_BUCKET Bucket,
+    _Out_ PKIRQL OldIrql
+    )
+{
+    LONG sequence;
+
+    KeRaiseIrql( DISPATCH_LEVEL, OldIrql );
+
+    for (;;) {
+
+        sequence = Bucket->Sequence;
+
+        if (((sequence & 1) == 0) &&
+            (InterlockedCompareExchange( &Bucket->Sequence, sequence + 1, sequence ) == sequence)) {
+
+            break;
+        }
+
+        YieldProcessor();
+    }
+}
+
+FORCEINLINE
+VOID
+AvCacheUnlockBucket (
+    _Inout_ PAV_CACHE_BUCKET Bucket,
+    _In_ KIRQL OldIrql
+    )
+{
+    InterlockedIncrement( &Bucket->Sequence );
+    KeLowerIrql( OldIrql );
+}
+
+
+NTSTATUS
+AvCacheInitialize (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    This routine allocates the file state cache.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    STATUS_SUCCESS or STATUS_INSUFFICIENT_RESOURCES.
+
+--*/
+{
+    SIZE_T size = AV_CACHE_BUCKET_COUNT * sizeof( AV_CACHE_BUCKET );
+
+    PAGED_CODE();
+
+    //
+    //  Writers own a bucket at DISPATCH_LEVEL, so it has to be non-paged.
+    //
+
+    Globals.Cache.Buckets = ExAllocatePoolWithTag( NonPagedPoolNx,
+                                                   size,
+                                                   AV_CACHE_TAG );
+
+    if (Globals.Cache.Buckets == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory( Globals.Cache.Buckets, size );
+    RtlZeroMemory( Globals.Cache.Counters, sizeof( Globals.Cache.Counters ) );
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+AvCacheFinalize (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    This routine frees the file state cache. All the instances must have
+    been torn down.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    if (Globals.Cache.Buckets != NULL) {
+
+        ExFreePoolWithTag( Globals.Cache.Buckets, AV_CACHE_TAG );
+        Globals.Cache.Buckets = NULL;
+    }
+}
+
+PAV_CACHE_BUCKET
+AvCacheGetBucket (
+    _In_ PFLT_VOLUME Volume,
+    _In_ PAV_FILE_REFERENCE FileId
+    )
+/*++
+
+Routine Description:
+
+    This routine returns the bucket that holds the given file.
+
+Arguments:
+
+    Volume - The volume the file is on.
+
+    FileId - The file ID of the file.
+
+Return Value:
+
+    The bucket.
+
+--*/
+{
+    ULONGLONG hash;
+
+    hash = FileId->FileId64.Value ^
+           FileId->FileId64.UpperZeroes ^
+           ((ULONG_PTR) Volume >> 4);
+
+    //
+    //  Fibonacci hashing: file IDs tend to be dense, so spread them with
+    //  the golden ratio and take the top bits.
+    //
+
+    hash *= 0x9E3779B97F4A7C15ull;
+
+    return &Globals.Cache.Buckets[(hash >> 32) & (AV_CACHE_BUCKET_COUNT - 1)];
+}
+
+PAV_CACHE_ENTRY
+AvCacheFindEntry (
+    _In_ PAV_CACHE_BUCKET Bucket,
+    _In_ PFLT_VOLUME Volume,
+    _In_ PAV_FILE_REFERENCE FileId
+    )
+/*++
+
+Routine Description:
+
+    This routine looks for the given file in a bucket. The caller either
+    owns the bucket or validates the result with the bucket's sequence
+    number.
+
+Arguments:
+
+    Bucket - The bucket to search.
+
+    Volume - The volume the file is on.
+
+    FileId - The file ID of the file.
+
+Return Value:
+
+    The entry, or NULL if the file is not in the bucket.
+
+--*/
+{
+    ULONG i;
+
+    for (i = 0; i < AV_CACHE_BUCKET_ENTRIES; i++) {
+
+        if ((Bucket->Entries[i].Volume == Volume) &&
+            AV_CACHE_FILE_ID_EQUAL( Bucket->Entries[i].FileId, *FileId )) {
+
+            return &Bucket->Entries[i];
+        }
+    }
+
+    return NULL;
+}
+
+BOOLEAN
+AvCacheReadEntry (
+    _In_ PAV_CACHE_BUCKET Bucket,
+    _In_ PFLT_VOLUME Volume,
+    _In_ PAV_FILE_REFERENCE FileId,
+    _Out_ PAV_CACHE_ENTRY Entry
+    )
+/*++
+
+Routine Description:
+
+    This routine copies the entry of a file out of a bucket without
+    owning it, retrying if a writer changed the bucket meanwhile.
+
+Arguments:
+
+    Bucket - The bucket that holds the file.
+
+    Volume - The volume the file is on.
+
+    FileId - The file ID of the file.
+
+    Entry - Receives a copy of the cached entry.
+
+Return Value:
+
+    TRUE if the file was found, FALSE otherwise.
+
+--*/
+{
+    PAV_CACHE_ENTRY entry;
+    LONG sequence;
+    BOOLEAN found;
+
+    for (;;) {
+
+        sequence = Bucket->Sequence;
+
+        if (sequence & 1) {
+
+            YieldProcessor();
+            continue;
+        }
+
+        KeMemoryBarrier();
+
+        entry = AvCacheFindEntry( Bucket, Volume, FileId );
+
+        found = (entry != NULL);
+
+        if (found) {
+
+            RtlCopyMemory( Entry, entry, sizeof( AV_CACHE_ENTRY ) );
+        }
+
+        //
+        //  If a writer got in while we were reading, what we read may be
+        //  torn. Read it again.
+        //
+
+        KeMemoryBarrier();
+
+        if (Bucket->Sequence == sequence) {
+
+            return found;
+        }
+    }
+}
+
+BOOLEAN
+AvCacheLookup (
+    _In_ PFLT_VOLUME Volume,
+    _In_ PAV_FILE_REFERENCE FileId,
+    _Out_ PAV_CACHE_ENTRY Entry
+    )
+/*++
+
+Routine Description:
+
+    This routine looks up the cached state of a file. It does not write to
+    the table.
+
+Arguments:
+
+    Volume - The volume the file is on.
+
+    FileId - The file ID of the file.
+
+    Entry - Receives a copy of the cached entry.
+
+Return Value:
+
+    TRUE if the file was found, FALSE otherwise.
+
+--*/
+{
+    BOOLEAN found;
+
+    AV_CACHE_COUNT( Lookups );
+
+    found = AvCacheReadEntry( AvCacheGetBucket( Volume, FileId ),
+                              Volume,
+                              FileId,
+                              Entry );
+
+    if (found) {
+
+        AV_CACHE_COUNT( Hits );
+    }
+
+    return found;
+}
+
+VOID
+AvCacheUpdate (
+    _In_ PAV_CACHE_ENTRY Entry
+    )
+/*++
+
+Routine Description:
+
+    This routine inserts or overwrites the cached state of a file. If the
+    cache already holds exactly this state nothing is written, so closing
+    a file that did not change does not take ownership of its bucket.
+
+Arguments:
+
+    Entry - The state to cache, including its key.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PAV_CACHE_BUCKET bucket = AvCacheGetBucket( Entry->Volume, &Entry->FileId );
+    PAV_CACHE_ENTRY entry;
+    AV_CACHE_ENTRY current;
+    KIRQL oldIrql;
+    ULONG i;
+
+    if (AvCacheReadEntry( bucket, Entry->Volume, &Entry->FileId, &current ) &&
+        (RtlCompareMemory( &current, Entry, sizeof( AV_CACHE_ENTRY ) ) == sizeof( AV_CACHE_ENTRY ))) {
+
+        return;
+    }
+
+    AvCacheLockBucket( bucket, &oldIrql );
+
+    entry = AvCacheFindEntry( bucket, Entry->Volume, &Entry->FileId );
+
+    if (entry == NULL) {
+
+        for (i = 0; i < AV_CACHE_BUCKET_ENTRIES; i++) {
+
+            if (bucket->Entries[i].Volume == NULL) {
+
+                entry = &bucket->Entries[i];
+                break;
+            }
+        }
+    }
+
+    if (entry == NULL) {
+
+        entry = &bucket->Entries[bucket->NextVictim];
+        bucket->NextVictim = (bucket->NextVictim + 1) % AV_CACHE_BUCKET_ENTRIES;
+
+        AV_CACHE_COUNT( Evictions );
+    }
+
+    RtlCopyMemory( entry, Entry, sizeof( AV_CACHE_ENTRY ) );
+
+    AvCacheUnlockBucket( bucket, oldIrql );
+
+    AV_CACHE_COUNT( Updates );
+}
+
+VOID
+AvCacheInvalidate (
+    _In_ PFLT_VOLUME Volume,
+    _In_ PAV_FILE_REFERENCE FileId,
+    _In_ BOOLEAN Stale
+    )
+/*++
+
+Routine Description:
+
+    This routine removes a file from the cache. It is called when the file
+    is about to be modified, and when a cached entry is found to be stale.
+    The bucket is only taken if the file is in it, so repeated writes to a
+    file are cheap.
+
+    This is non-pageable because it could be called on the paging path
+
+Arguments:
+
+    Volume - The volume the file is on.
+
+    FileId - The file ID of the file.
+
+    Stale - TRUE if the entry was found to be out of date by a lookup.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PAV_CACHE_BUCKET bucket = AvCacheGetBucket( Volume, FileId );
+    PAV_CACHE_ENTRY entry;
+    AV_CACHE_ENTRY current;
+    KIRQL oldIrql;
+
+    if (!AvCacheReadEntry( bucket, Volume, FileId, &current )) {
+
+        return;
+    }
+
+    AvCacheLockBucket( bucket, &oldIrql );
+
+    entry = AvCacheFindEntry( bucket, Volume, FileId );
+
+    if (entry != NULL) {
+
+        RtlZeroMemory( entry, sizeof( AV_CACHE_ENTRY ) );
+    }
+
+    AvCacheUnlockBucket( bucket, oldIrql );
+
+    if (Stale) {
+
+        AV_CACHE_COUNT( StaleHits );
+
+    } else {
+
+        AV_CACHE_COUNT( Invalidations );
+    }
+}
+
+VOID
+AvCachePurgeVolume (
+    _In_ PFLT_VOLUME Volume
+    )
+/*++
+
+Routine Description:
+
+    This routine removes all the files of a volume from the cache. It is
+    called when our instance on the volume is torn down.
+
+Arguments:
+
+    Volume - The volume being torn down.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PAV_CACHE_BUCKET bucket;
+    KIRQL oldIrql;
+    ULONG b, i;
+
+    for (b = 0; b < AV_CACHE_BUCKET_COUNT; b++) {
+
+        bucket = &Globals.Cache.Buckets[b];
+
+        AvCacheLockBucket( bucket, &oldIrql );
+
+        for (i = 0; i < AV_CACHE_BUCKET_ENTRIES; i++) {
+
+            if (bucket->Entries[i].Volume == Volume) {
+
+                AV_DBG_PRINT( AVDBG_TRACE_ROUTINES,
+                      ("[AV] AvCachePurgeVolume: %I64x,%I64x requesting deletion, state:%d\n",
+                            bucket->Entries[i].FileId.FileId64.UpperZeroes,
+                            bucket->Entries[i].FileId.FileId64.Value,
+                            bucket->Entries[i].InfectedState) );
+
+                RtlZeroMemory( &bucket->Entries[i], sizeof( AV_CACHE_ENTRY ) );
+            }
+        }
+
+        AvCacheUnlockBucket( bucket, oldIrql );
+    }
+}
+
+VOID
+AvCacheQueryStatistics (
+    _Out_ PAV_CACHE_STATISTICS Statistics
+    )
+/*++
+
+Routine Description:
+
+    This routine sums up the per processor cache counters.
+
+Arguments:
+
+    Statistics - Receives the totals.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PAV_CACHE_COUNTERS counters;
+    ULONG i;
+
+    PAGED_CODE();
+
+    RtlZeroMemory( Statistics, sizeof( AV_CACHE_STATISTICS ) );
+
+    for (i = 0; i < AV_CACHE_COUNTER_SLOTS; i++) {
+
+        counters = &Globals.Cache.Counters[i];
+
+        Statistics->Lookups += counters->Lookups;
+        Statistics->Hits += counters->Hits;
+        Statistics->StaleHits += counters->StaleHits;
+        Statistics->Updates += counters->Updates;
+        Statistics->Invalidations += counters->Invalidations;
+        Statistics->Evictions += counters->Evictions;
+    }
+}
@@ -0,0 +1,147 @@
+/*++
+
+Copyright (c) 2011  Microsoft Corporation
+
+Module Name:
+
+    cache.h
+
+Abstract:
+
+    This module contains the interface of the file state cache shared by
+    all the instances of the AV filter.
+
+Environment:
+
+    Kernel mode
+
+--*/
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#define AV_CACHE_TAG                         'hCvA'
+
+//
+//  The file state cache is a fixed size hash table keyed by volume and
+//  file ID. Each bucket holds a few entries and a sequence number that is
+//  odd while a writer is changing the bucket. Readers never write to the
+//  table: they copy the entry they want and retry if the sequence number
+//  changed underneath them, so lookups of the same files from many
+//  processors do not contend. Writers raise to DISPATCH_LEVEL and own the
+//  bucket for the few instructions it takes to update it; no I/O is ever
+//  done while a bucket is owned.
+//
+//  When a bucket is full the entries are replaced round robin. The table
+//  is bounded, unlike the AVL tree it replaces; consider sizing it from
+//  the registry for a production filter.
+//
+
+#define AV_CACHE_BUCKET_COUNT                2048    // must be a power of 2
+#define AV_CACHE_BUCKET_ENTRIES              4
+
+//
+//  The number of sets of statistics counters. Counters are kept per
+//  processor (modulo this number) so that counting does not contend.
+//
+
+#define AV_CACHE_COUNTER_SLOTS               64
+
+typedef struct _AV_CACHE_ENTRY {
+
+    //
+    //  The key. Volume is NULL if the entry is free.
+    //
+
+    PFLT_VOLUME        Volume;
+    AV_FILE_REFERENCE  FileId;
+
+    //
+    //  Please see AV_FILE_INFECTED_STATE for the definition of file state
+    //
+
+    LONG       InfectedState;
+
+    //
+    //  The update sequence number of the file when the state was cached,
+    //  or zero if it could not be read.
+    //
+
+    USN        Usn;
+
+    //
+    // Revision numbers for files on CSVFS
+    //
+    LONGLONG   VolumeRevision;
+    LONGLONG   CacheRevision;
+    LONGLONG   FileRevision;
+
+} AV_CACHE_ENTRY, *PAV_CACHE_ENTRY;
+
+typedef struct DECLSPEC_CACHEALIGN _AV_CACHE_BUCKET {
+
+    volatile LONG  Sequence;
+    ULONG          NextVictim;
+
+    AV_CACHE_ENTRY Entries[AV_CACHE_BUCKET_ENTRIES];
+
+} AV_CACHE_BUCKET, *PAV_CACHE_BUCKET;
+
+typedef struct DECLSPEC_CACHEALIGN _AV_CACHE_COUNTERS {
+
+    LONG64  Lookups;
+    LONG64  Hits;
+    LONG64  StaleHits;
+    LONG64  Updates;
+    LONG64  Invalidations;
+    LONG64  Evictions;
+
+} AV_CACHE_COUNTERS, *PAV_CACHE_COUNTERS;
+
+typedef struct _AV_CACHE {
+
+    PAV_CACHE_BUCKET   Buckets;
+
+    AV_CACHE_COUNTERS  Counters[AV_CACHE_COUNTER_SLOTS];
+
+} AV_CACHE, *PAV_CACHE;
+
+NTSTATUS
+AvCacheInitialize (
+    VOID
+    );
+
+VOID
+AvCacheFinalize (
+    VOID
+    );
+
+BOOLEAN
+AvCacheLookup (
+    _In_ PFLT_VOLUME Volume,
+    _In_ PAV_FILE_REFERENCE FileId,
+    _Out_ PAV_CACHE_ENTRY Entry
+    );
+
+VOID
+AvCacheUpdate (
+    _In_ PAV_CACHE_ENTRY Entry
+    );
+
+VOID
+AvCacheInvalidate (
+    _In_ PFLT_VOLUME Volume,
+    _In_ PAV_FILE_REFERENCE FileId,
+    _In_ BOOLEAN Stale
+    );
+
+VOID
+AvCachePurgeVolume (
+    _In_ PFLT_VOLUME Volume
+    );
+
+VOID
+AvCacheQueryStatistics (
+    _Out_ PAV_CACHE_STATISTICS Statistics
+    );
+
+#endif
@@ -85,6 +85,14 @@ AvHandleCmdCreateSectionForDataScan (
     _Out_ PHANDLE SectionHandle
     );
     
+NTSTATUS
+AvHandleCmdCreateSectionsForDataScan (
+    _In_ ULONG BatchCount,
+    _In_reads_(BatchCount) PLONGLONG ScanIds,
+    _Out_writes_(BatchCount) PAV_SECTION_BATCH_ENTRY Entries,
+    _Out_ PULONG ReturnOutputBufferLength
+    );
+    
 NTSTATUS
 AvHandleCmdCloseSectionForDataScan (
     _Inout_  PAV_SCAN_CONTEXT ScanContext,
@@ -105,6 +113,7 @@ AvHandleCmdCloseSectionForDataScan (
     #pragma alloc_text(PAGE, AvFinalizeScanContext)
     #pragma alloc_text(PAGE, AvFinalizeSectionContext)
     #pragma alloc_text(PAGE, AvHandleCmdCreateSectionForDataScan)
+    #pragma alloc_text(PAGE, AvHandleCmdCreateSectionsForDataScan)
     #pragma alloc_text(PAGE, AvHandleCmdCloseSectionForDataScan)
 #endif
 
@@ -743,6 +752,7 @@ Cleanup:
         
         if (!NT_SUCCESS( status )) {
         
+            AvInvalidateDirtyRanges( streamContext );
             SET_FILE_MODIFIED_EX( ScanContext->IsFileInTxWriter, streamContext );
         }
         
@@ -786,6 +796,111 @@ Cleanup:
     return status;
 }
 
+NTSTATUS
+AvHandleCmdCreateSectionsForDataScan (
+    _In_ ULONG BatchCount,
+    _In_reads_(BatchCount) PLONGLONG ScanIds,
+    _Out_writes_(BatchCount) PAV_SECTION_BATCH_ENTRY Entries,
+    _Out_ PULONG ReturnOutputBufferLength
+    )
+/*++
+
+Routine Description:
+
+    This function handles CmdCreateSectionsForDataScan message.
+    It creates the section objects for a batch of pending scans, so that a
+    burst of scan requests costs the user program one round trip instead
+    of one per file.
+
+    Each scan is handled exactly as AvHandleCmdCreateSectionForDataScan
+    would; a failure only affects its own entry.
+    
+    NOTE: ScanIds must be a captured kernel copy. Entries is the raw
+    user output buffer, whose size and alignment must be checked before
+    passing into this function.
+
+Arguments:
+
+    BatchCount - The number of scans in this batch.
+    ScanIds - The scan ids of the batch.
+    Entries - The user buffer that receives the section handles.
+    ReturnOutputBufferLength - Receives the number of bytes written.
+
+Return Value:
+
+    Returns the status of processing the message.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    ULONG i;
+    PAV_SCAN_CONTEXT scanContexts[AV_SECTION_BATCH_MAX] = {0};
+    HANDLE sectionHandles[AV_SECTION_BATCH_MAX] = {0};
+    NTSTATUS statuses[AV_SECTION_BATCH_MAX];
+    
+    PAGED_CODE();
+
+    ASSERT( BatchCount <= AV_SECTION_BATCH_MAX );
+
+    for (i = 0; i < BatchCount; i++) {
+
+        statuses[i] = AvGetScanCtxSynchronized( ScanIds[i],
+                                                &scanContexts[i] );
+
+        if (!NT_SUCCESS( statuses[i] )) {
+
+            scanContexts[i] = NULL;
+            statuses[i] = STATUS_NOT_FOUND;
+            continue;
+        }
+
+        statuses[i] = AvHandleCmdCreateSectionForDataScan( scanContexts[i],
+                                                           &sectionHandles[i] );
+    }
+
+    try {
+
+        for (i = 0; i < BatchCount; i++) {
+
+            Entries[i].SectionHandle = NT_SUCCESS( statuses[i] ) ? sectionHandles[i] : NULL;
+            Entries[i].Status = statuses[i];
+        }
+        *ReturnOutputBufferLength = BatchCount * sizeof( AV_SECTION_BATCH_ENTRY );
+
+    } except (AvExceptionFilter( GetExceptionInformation(), TRUE )) {
+
+        //
+        //  The user program will never see these handles, so close them
+        //  and release the waiting I/O request threads ourselves, just as
+        //  the single section case does.
+        //
+
+        for (i = 0; i < BatchCount; i++) {
+
+            if (NT_SUCCESS( statuses[i] )) {
+
+                NtClose( sectionHandles[i] );
+                AvFinalizeScanAndSection( scanContexts[i] );
+            }
+        }
+        status = GetExceptionCode();
+    }
+
+    //
+    //  AvGetScanCtxSynchronized incremented the ref count of scan contexts
+    //
+
+    for (i = 0; i < BatchCount; i++) {
+
+        if (scanContexts[i] != NULL) {
+
+            AvReleaseScanContext( scanContexts[i] );
+        }
+    }
+    
+    return status;
+}
+
 
 NTSTATUS
 AvUpdateStreamContextWithScanResult (
@@ -828,9 +943,17 @@ Return Value:
             //  set the file state back to AvFileModifed.
             //
             
+            AvInvalidateDirtyRanges( StreamContext );
             SET_FILE_MODIFIED_EX( ScanContext->IsFileInTxWriter, StreamContext);
             break;
         case AvScanResultInfected:
+
+            //
+            //  The next scan must not assume any part of the file is clean.
+            //
+
+            AvInvalidateDirtyRanges( StreamContext );
+
             //
             //  If after the scan and before setting this file as clean, the file gets modified, 
             //  then we have to leave it as modified.
@@ -856,6 +979,17 @@ Return Value:
                 
                 InterlockedCompareExchange( &StreamContext->TxState, AvFileNotInfected, AvFileScanning );
                 
+            } else if (AvHasDirtyRanges( StreamContext )) {
+
+                //
+                //  A write that landed before the file was set to scanning 
+                //  had its modified state overwritten, and may not have been 
+                //  covered by the scanned ranges. Leave the file modified so 
+                //  that just the new ranges get scanned.
+                //
+
+                InterlockedCompareExchange( &StreamContext->State, AvFileModified, AvFileScanning );
+
             } else {
             
                 InterlockedCompareExchange( &StreamContext->State, AvFileNotInfected, AvFileScanning );
@@ -1098,6 +1232,7 @@ Routine Description:
     2) Close the section for data scan
     3) Set a certain file to be infected
     4) Query the file state of a file
+    5) Query the file state cache statistics
 
 Arguments:
 
@@ -1129,6 +1264,9 @@ Return Value:
     AVSCAN_RESULT scanResult = AvScanResultUndetermined;
     PAV_STREAM_CONTEXT streamContext;
     HANDLE sectionHandle;
+    AV_CACHE_STATISTICS cacheStatistics;
+    ULONG batchCount = 0;
+    LONGLONG batchScanIds[AV_SECTION_BATCH_MAX];
     
     PAGED_CODE();
 
@@ -1322,6 +1460,76 @@ Return Value:
             FltReleaseContext( streamContext );
                         
             break;
+
+        case AvCmdQueryCacheStatistics:
+
+            if ((OutputBufferSize < sizeof (AV_CACHE_STATISTICS)) ||
+                        (OutputBuffer == NULL)) {
+
+                return STATUS_INVALID_PARAMETER;
+            }
+
+            if (!IS_ALIGNED(OutputBuffer,sizeof(ULONGLONG))) {
+
+                return STATUS_DATATYPE_MISALIGNMENT;
+            }
+
+            AvCacheQueryStatistics( &cacheStatistics );
+
+            try {
+
+                RtlCopyMemory( OutputBuffer, &cacheStatistics, sizeof( AV_CACHE_STATISTICS ) );
+                *ReturnOutputBufferLength = (ULONG) sizeof( AV_CACHE_STATISTICS );
+
+            } except (AvExceptionFilter( GetExceptionInformation(), TRUE )) {
+
+                status = GetExceptionCode();
+            }
+
+            break;
+
+        case AvCmdCreateSectionsForDataScan:
+
+            if (InputBufferSize < sizeof (COMMAND_BATCH_MESSAGE)) {
+
+                return STATUS_INVALID_PARAMETER;
+            }
+
+            try {
+
+                batchCount = ((PCOMMAND_BATCH_MESSAGE) InputBuffer)->Header.BatchCount;
+
+                if ((batchCount == 0) ||
+                    (batchCount > AV_SECTION_BATCH_MAX)) {
+
+                    return STATUS_INVALID_PARAMETER;
+                }
+
+                RtlCopyMemory( batchScanIds,
+                               ((PCOMMAND_BATCH_MESSAGE) InputBuffer)->ScanIds,
+                               batchCount * sizeof( LONGLONG ) );
+
+            } except (AvExceptionFilter( GetExceptionInformation(), TRUE )) {
+
+                return GetExceptionCode();
+            }
+
+            if ((OutputBufferSize < batchCount * sizeof (AV_SECTION_BATCH_ENTRY)) ||
+                    (OutputBuffer == NULL)) {
+
+                return STATUS_INVALID_PARAMETER;
+            }
+
+            if (!IS_ALIGNED(OutputBuffer,sizeof(HANDLE))) {
+
+                return STATUS_DATATYPE_MISALIGNMENT;
+            }
+
+            status = AvHandleCmdCreateSectionsForDataScan( batchCount,
+                                                           batchScanIds,
+                                                           (PAV_SECTION_BATCH_ENTRY) OutputBuffer,
+                                                           ReturnOutputBufferLength );
+            break;
             
         default:
             return STATUS_INVALID_PARAMETER;
@@ -136,6 +136,7 @@ Return Value:
                    NULL == streamContext->TxContext );
                    
     AvFreeKevent( streamContext->ScanSynchronizationEvent );
+    FltDeletePushLock( &streamContext->DirtyRangeLock );
 }
 
 VOID
@@ -235,7 +236,8 @@ Routine Description:
     In this routine, the driver has to perform any needed cleanup, such as freeing 
     additional memory that the minifilter driver allocated inside the context structure.
     
-    We delete the cache table if the file system supports one.
+    The files of the volume were already removed from the file state cache
+    at instance teardown, so there is nothing to free.
     
 Arguments:
 
@@ -249,8 +251,6 @@ Return Value:
 --*/
 {
 
-    PAV_INSTANCE_CONTEXT instanceContext = (PAV_INSTANCE_CONTEXT) Context;
-
     UNREFERENCED_PARAMETER( Context );
     UNREFERENCED_PARAMETER( ContextType );
     
@@ -258,13 +258,6 @@ Return Value:
     
     AV_DBG_PRINT( AVDBG_TRACE_ROUTINES,
                 ( "[Av]: AvInstanceContextCleanup context cleanup entered\n") );
-    
-    if (FS_SUPPORTS_FILE_STATE_CACHE( instanceContext->VolumeFSType )) {
-    
-        FLT_ASSERTMSG( "[AV] AvInstanceContextCleanup: The generic table should be empty at cleanup.\n", 
-                        RtlIsGenericTableEmpty( &instanceContext->FileStateCacheTable ) );
-        ExDeleteResourceLite( &instanceContext->Resource );
-    }
 }
 
 NTSTATUS
@@ -387,11 +380,250 @@ Return Value:
     KeInitializeEvent( streamContext->ScanSynchronizationEvent, SynchronizationEvent, TRUE ); 
     SET_FILE_MODIFIED( streamContext );
     SET_FILE_TX_MODIFIED( streamContext );
+
+    //
+    //  Nothing is known about the file yet, so its first scan covers all of it.
+    //
+
+    FltInitializePushLock( &streamContext->DirtyRangeLock );
+    streamContext->DirtyRangesWhole = TRUE;
     *StreamContext = streamContext;
 
     return STATUS_SUCCESS;
 }
 
+VOID
+AvAddDirtyRange (
+    _Inout_ PAV_STREAM_CONTEXT StreamContext,
+    _In_ LONGLONG Offset,
+    _In_ ULONG Length
+    )
+/*++
+
+Routine Description
+
+    This routine records that a byte range of the stream was written.
+    The range is merged with any range it overlaps or nearly touches; 
+    once all the slots are in use it is merged with the nearest one 
+    instead, so the ranges only ever grow to cover more of the file.
+
+    This is non-pageable because it could be called on the paging path.
+
+Arguments
+
+    StreamContext - The stream context of the written stream.
+
+    Offset - The starting byte offset of the write.
+
+    Length - The length in bytes of the write.
+
+Return Value
+
+    None.
+
+--*/
+{
+    LONGLONG start = Offset;
+    LONGLONG end = Offset + Length;
+    LONGLONG gap;
+    LONGLONG nearestGap = MAXLONGLONG;
+    ULONG nearest = 0;
+    ULONG i;
+    PAV_SCAN_RANGE range;
+
+    if (Length == 0) {
+
+        return;
+    }
+
+    FltAcquirePushLockExclusive( &StreamContext->DirtyRangeLock );
+
+    if (StreamContext->DirtyRangesWhole) {
+
+        goto Cleanup;
+    }
+
+    //
+    //  Absorb every range that would be scanned together with this one anyway.
+    //
+
+    for (i = 0; i < StreamContext->DirtyRangeCount; ) {
+
+        range = &StreamContext->DirtyRanges[i];
+
+        if ((range->Offset <= end + 2 * AV_DIRTY_RANGE_MARGIN) &&
+            (start <= range->Offset + range->Length + 2 * AV_DIRTY_RANGE_MARGIN)) {
+
+            start = min( start, range->Offset );
+            end = max( end, range->Offset + range->Length );
+
+            *range = StreamContext->DirtyRanges[--StreamContext->DirtyRangeCount];
+            continue;
+        }
+
+        i++;
+    }
+
+    if (StreamContext->DirtyRangeCount == AV_SCAN_RANGE_MAX) {
+
+        for (i = 0; i < StreamContext->DirtyRangeCount; i++) {
+
+            range = &StreamContext->DirtyRanges[i];
+
+            gap = (range->Offset > end) ? (range->Offset - end) :
+                                          (start - (range->Offset + range->Length));
+
+            if (gap < nearestGap) {
+
+                nearestGap = gap;
+                nearest = i;
+            }
+        }
+
+        range = &StreamContext->DirtyRanges[nearest];
+
+        start = min( start, range->Offset );
+        end = max( end, range->Offset + range->Length );
+
+        *range = StreamContext->DirtyRanges[--StreamContext->DirtyRangeCount];
+    }
+
+    range = &StreamContext->DirtyRanges[StreamContext->DirtyRangeCount++];
+    range->Offset = start;
+    range->Length = end - start;
+
+Cleanup:
+
+    FltReleasePushLock( &StreamContext->DirtyRangeLock );
+}
+
+VOID
+AvInvalidateDirtyRanges (
+    _Inout_ PAV_STREAM_CONTEXT StreamContext
+    )
+/*++
+
+Routine Description
+
+    This routine records that the stream was changed in a way that is not
+    described by byte ranges, or that its last scan did not find it clean,
+    so the next scan must cover the whole file.
+
+    This is non-pageable because it could be called on the paging path.
+
+Arguments
+
+    StreamContext - The stream context.
+
+Return Value
+
+    None.
+
+--*/
+{
+    FltAcquirePushLockExclusive( &StreamContext->DirtyRangeLock );
+
+    StreamContext->DirtyRangesWhole = TRUE;
+    StreamContext->DirtyRangeCount = 0;
+
+    FltReleasePushLock( &StreamContext->DirtyRangeLock );
+}
+
+VOID
+AvCaptureDirtyRanges (
+    _Inout_ PAV_STREAM_CONTEXT StreamContext,
+    _Out_ PULONG RangeCount,
+    _Out_writes_(AV_SCAN_RANGE_MAX) PAV_SCAN_RANGE Ranges
+    )
+/*++
+
+Routine Description
+
+    This routine is called when a scan of the stream starts. It returns the
+    ranges the scan has to cover, widened by AV_DIRTY_RANGE_MARGIN, and 
+    starts recording afresh so that writes racing with the scan are kept
+    for the next one.
+    
+    If the scan does not find the file clean, the caller must call 
+    AvInvalidateDirtyRanges, since the captured ranges are gone.
+
+Arguments
+
+    StreamContext - The stream context of the stream to be scanned.
+
+    RangeCount - Receives the number of ranges to scan. Zero means the
+        whole file has to be scanned.
+
+    Ranges - Receives the ranges to scan.
+
+Return Value
+
+    None.
+
+--*/
+{
+    ULONG i;
+    LONGLONG start;
+    PAV_SCAN_RANGE range;
+
+    FltAcquirePushLockExclusive( &StreamContext->DirtyRangeLock );
+
+    *RangeCount = 0;
+
+    if (!StreamContext->DirtyRangesWhole) {
+
+        for (i = 0; i < StreamContext->DirtyRangeCount; i++) {
+
+            range = &StreamContext->DirtyRanges[i];
+            start = max( 0, range->Offset - AV_DIRTY_RANGE_MARGIN );
+
+            Ranges[i].Offset = start;
+            Ranges[i].Length = range->Offset + range->Length + AV_DIRTY_RANGE_MARGIN - start;
+        }
+
+        *RangeCount = StreamContext->DirtyRangeCount;
+    }
+
+    StreamContext->DirtyRangesWhole = FALSE;
+    StreamContext->DirtyRangeCount = 0;
+
+    FltReleasePushLock( &StreamContext->DirtyRangeLock );
+}
+
+BOOLEAN
+AvHasDirtyRanges (
+    _In_ PAV_STREAM_CONTEXT StreamContext
+    )
+/*++
+
+Routine Description
+
+    This routine checks whether the stream was written since its ranges 
+    were last captured. A scan that finds such a file clean did not 
+    necessarily cover those writes, so the file must stay modified.
+
+Arguments
+
+    StreamContext - The stream context.
+
+Return Value
+
+    TRUE if there is anything left to scan.
+
+--*/
+{
+    BOOLEAN dirty;
+
+    FltAcquirePushLockShared( &StreamContext->DirtyRangeLock );
+
+    dirty = StreamContext->DirtyRangesWhole ||
+            (StreamContext->DirtyRangeCount > 0);
+
+    FltReleasePushLock( &StreamContext->DirtyRangeLock );
+
+    return dirty;
+}
+
 NTSTATUS
 AvFindOrCreateTransactionContext(
     _In_ PCFLT_RELATED_OBJECTS FltObjects,
@@ -215,9 +215,28 @@ typedef struct _AV_STREAM_CONTEXT {
     LONGLONG   VolumeRevision;
     LONGLONG   CacheRevision;
     LONGLONG   FileRevision;
+
+    //
+    //  The byte ranges written since the last scan was started, so that
+    //  a file that was clean only needs those rescanned. If 
+    //  DirtyRangesWhole is set, or the ranges are unknown, the whole 
+    //  file has to be scanned. Protected by DirtyRangeLock.
+    //
+
+    EX_PUSH_LOCK   DirtyRangeLock;
+    BOOLEAN        DirtyRangesWhole;
+    ULONG          DirtyRangeCount;
+    AV_SCAN_RANGE  DirtyRanges[AV_SCAN_RANGE_MAX];
     
 } AV_STREAM_CONTEXT, *PAV_STREAM_CONTEXT;
 
+//
+//  The number of bytes scanned on either side of a dirty range, so that a
+//  signature straddling the edge of a write is still found.
+//
+
+#define AV_DIRTY_RANGE_MARGIN          ((LONGLONG)AV_DEFAULT_SEARCH_PATTERN_SIZE - 1)
+
 #define AV_STREAM_CONTEXT_SIZE         sizeof( AV_STREAM_CONTEXT )
 
 //
@@ -293,19 +312,6 @@ typedef struct _AV_INSTANCE_CONTEXT {
     
     FLT_FILESYSTEM_TYPE VolumeFSType;
     
-    //
-    //  If the file system is NTFS, then it will support a file state cache table 
-    //  that saves the state of the file.
-    //
-    
-    RTL_GENERIC_TABLE  FileStateCacheTable;
-    
-    //
-    //  The per-instance lock to protect the cache table above.
-    //
-    
-    ERESOURCE   Resource;
-
     //
     //  When set this flag indicates that the filter is attached on the
     //  hidden NTFS volume corresponding to a CSVFS volume
@@ -341,6 +347,30 @@ AvCreateStreamContext (
     _Outptr_ PAV_STREAM_CONTEXT *StreamContext
     );
 
+VOID
+AvAddDirtyRange (
+    _Inout_ PAV_STREAM_CONTEXT StreamContext,
+    _In_ LONGLONG Offset,
+    _In_ ULONG Length
+    );
+
+VOID
+AvInvalidateDirtyRanges (
+    _Inout_ PAV_STREAM_CONTEXT StreamContext
+    );
+
+VOID
+AvCaptureDirtyRanges (
+    _Inout_ PAV_STREAM_CONTEXT StreamContext,
+    _Out_ PULONG RangeCount,
+    _Out_writes_(AV_SCAN_RANGE_MAX) PAV_SCAN_RANGE Ranges
+    );
+
+BOOLEAN
+AvHasDirtyRanges (
+    _In_ PAV_STREAM_CONTEXT StreamContext
+    );
+
 NTSTATUS
 AvEnumerateInstances(
     _Outptr_result_buffer_(*NumberInstances) PFLT_INSTANCE **InstanceArray,
@@ -825,9 +825,14 @@ Return Value:
     
     //
     // if it has been determined that a rescan is needed then set the
-    // file modified flag on the stream context to indicate this
+    // file modified flag on the stream context to indicate this.
+    // The file may have been changed from another node, so the
+    // whole file needs to be rescanned.
     //
     if (needRescanOnCsvfs) {
+
+        AvInvalidateDirtyRanges( StreamContext );
+
         if ( StreamContext->TxContext != NULL) {
 
             //
@@ -1003,9 +1008,14 @@ Return Value:
     
     //
     // if it has been determined that a rescan is needed then set the
-    // file modified flag on the stream context to indicate this
+    // file modified flag on the stream context to indicate this.
+    // The file may have been changed from another node, so the
+    // whole file needs to be rescanned.
     //
     if (needRescanOnCsvfs) {
+
+        AvInvalidateDirtyRanges( StreamContext );
+
         if ( StreamContext->TxContext != NULL) {
 
             //
@@ -32,6 +32,8 @@ AvScanMemoryStream(
 NTSTATUS
 AvMapSectionAndScan(
     _Inout_ PAV_SECTION_CONTEXT SectionContext,
+    _In_ ULONG RangeCount,
+    _In_reads_(RangeCount) PAV_SCAN_RANGE Ranges,
     _Out_ AVSCAN_RESULT *ScanResult
     );
     
@@ -123,6 +125,8 @@ Return Value
 NTSTATUS
 AvMapSectionAndScan(
     _Inout_ PAV_SECTION_CONTEXT SectionContext,
+    _In_ ULONG RangeCount,
+    _In_reads_(RangeCount) PAV_SCAN_RANGE Ranges,
     _Out_ AVSCAN_RESULT *ScanResult
     )
 /*++
@@ -130,10 +134,16 @@ AvMapSectionAndScan(
 Routine Description
 
     A helper function to map the section object and scan the mapped memory.
+    If ranges are given only those parts of the view are scanned, so only
+    their pages are read in.
 
 Arguments
     
     SectionContext - Section context containing section object and handle.
+
+    RangeCount - The number of ranges to scan, zero to scan the whole file.
+
+    Ranges - The byte ranges of the file to scan.
             
     Infected - Return TRUE if the file is infected.
 
@@ -149,6 +159,8 @@ Return Value
     HANDLE processHandle = NULL;
     PVOID scanAddress = NULL;
     SIZE_T scanSize = 0;
+    LONGLONG viewSize;
+    ULONG i;
     AVSCAN_RESULT scanResult;
     
     clientId.UniqueThread = PsGetCurrentThreadId();
@@ -195,9 +207,35 @@ Return Value
     //
     //  The size here may have truncation.
     //
-    scanResult = AvScanMemoryStream( scanAddress, 
-                                     (SIZE_T)min((LONGLONG)scanSize, SectionContext->FileSize),
-                                     &SectionContext->Aborted );
+    viewSize = min((LONGLONG)scanSize, SectionContext->FileSize);
+
+    if (RangeCount == 0) {
+
+        scanResult = AvScanMemoryStream( scanAddress, 
+                                         (SIZE_T)viewSize,
+                                         &SectionContext->Aborted );
+    } else {
+
+        //
+        //  The file may have been truncated since the ranges were recorded.
+        //
+
+        scanResult = AvScanResultClean;
+
+        for (i = 0;
+             (i < RangeCount) && (scanResult == AvScanResultClean);
+             i++) {
+
+            if (Ranges[i].Offset >= viewSize) {
+
+                continue;
+            }
+
+            scanResult = AvScanMemoryStream( (PUCHAR)scanAddress + (SIZE_T)Ranges[i].Offset, 
+                                             (SIZE_T)min(Ranges[i].Length, viewSize - Ranges[i].Offset),
+                                             &SectionContext->Aborted );
+        }
+    }
 
     *ScanResult = scanResult;
     
@@ -221,7 +259,9 @@ AvScanInKernel (
     _In_ PCFLT_RELATED_OBJECTS FltObjects,
     _In_ UCHAR IOMajorFunctionAtScan,
     _In_ BOOLEAN IsInTxWriter,
-    _In_ PAV_STREAM_CONTEXT StreamContext
+    _In_ PAV_STREAM_CONTEXT StreamContext,
+    _In_ ULONG RangeCount,
+    _In_reads_(RangeCount) PAV_SCAN_RANGE Ranges
     )
 /*++
 
@@ -240,6 +280,10 @@ Arguments
 
     StreamContext - The stream context of this data stream.
 
+    RangeCount - The number of ranges to scan, zero to scan the whole file.
+
+    Ranges - The byte ranges of the file to scan.
+
 Return Value
 
     Returns the status of this operation.
@@ -291,7 +335,7 @@ Return Value
         return status;
     }
     
-    status = AvMapSectionAndScan( sectionContext, &scanResult );
+    status = AvMapSectionAndScan( sectionContext, RangeCount, Ranges, &scanResult );
     
     if (!NT_SUCCESS( status )) {
 
@@ -306,8 +350,16 @@ Return Value
               ("[AV] AvScanInKernel: file %I64x,%I64x is CLEAN!!\n", 
                StreamContext->FileId.FileId64.UpperZeroes,
                StreamContext->FileId.FileId64.Value) );
+
+            //
+            //  A write that raced with the scan may not have been covered 
+            //  by it, so leave the file modified to have just that rescanned.
+            //
+
+            if (IsInTxWriter || !AvHasDirtyRanges( StreamContext )) {
                
-            SET_FILE_NOT_INFECTED_EX( IsInTxWriter, StreamContext );
+                SET_FILE_NOT_INFECTED_EX( IsInTxWriter, StreamContext );
+            }
 
     } else if (scanResult == AvScanResultInfected) {
 
@@ -316,6 +368,7 @@ Return Value
            StreamContext->FileId.FileId64.UpperZeroes,
            StreamContext->FileId.FileId64.Value) );
 
+        AvInvalidateDirtyRanges( StreamContext );
         SET_FILE_INFECTED_EX( IsInTxWriter, StreamContext );
         
     } else {
@@ -325,6 +378,7 @@ Return Value
            StreamContext->FileId.FileId64.UpperZeroes,
            StreamContext->FileId.FileId64.Value) );
 
+        AvInvalidateDirtyRanges( StreamContext );
         SET_FILE_UNKNOWN_EX( IsInTxWriter, StreamContext );
     }
     
@@ -339,7 +393,9 @@ AvScanInUser (
     _In_ PCFLT_RELATED_OBJECTS FltObjects,
     _In_ UCHAR IOMajorFunctionAtScan,
     _In_ BOOLEAN IsInTxWriter,
-    _In_ DEVICE_TYPE DeviceType
+    _In_ DEVICE_TYPE DeviceType,
+    _In_ ULONG RangeCount,
+    _In_reads_(RangeCount) PAV_SCAN_RANGE Ranges
     )
 /*++
 
@@ -358,7 +414,11 @@ Arguments
     
     IsInTxWriter - If this file is enlisted in a transacted writer.
     
-    StreamContext - The stream context of this data stream.
+    DeviceType - The device type of the volume, used to pick the scan timeout.
+
+    RangeCount - The number of ranges to scan, zero to scan the whole file.
+
+    Ranges - The byte ranges of the file to scan.
 
 Return Value
 
@@ -418,6 +478,10 @@ Return Value
         notification.Reason = AvScanOnCleanup;
     }
 
+    ASSERT( RangeCount <= AV_SCAN_RANGE_MAX );
+    notification.RangeCount = RangeCount;
+    RtlCopyMemory( notification.Ranges, Ranges, RangeCount * sizeof( AV_SCAN_RANGE ) );
+
     //
     //  Set the scan timeout for this file based on if it is a local or
     //  network file.  These values can come from the registry.
@@ -37,7 +37,9 @@ AvScanInKernel (
     _In_ PCFLT_RELATED_OBJECTS FltObjects,
     _In_ UCHAR IOMajorFunctionAtScan,
     _In_ BOOLEAN IsInTxWriter,
-    _In_ PAV_STREAM_CONTEXT StreamContext
+    _In_ PAV_STREAM_CONTEXT StreamContext,
+    _In_ ULONG RangeCount,
+    _In_reads_(RangeCount) PAV_SCAN_RANGE Ranges
     );
     
 NTSTATUS
@@ -46,7 +48,9 @@ AvScanInUser (
     _In_ PCFLT_RELATED_OBJECTS FltObjects,
     _In_ UCHAR IOMajorFunctionAtScan,
     _In_ BOOLEAN IsInTxWriter,
-    _In_ DEVICE_TYPE DeviceType
+    _In_ DEVICE_TYPE DeviceType,
+    _In_ ULONG RangeCount,
+    _In_reads_(RangeCount) PAV_SCAN_RANGE Ranges
     );
     
 NTSTATUS
@@ -11,7 +11,7 @@ Abstract:
     Header file which contains the structures, type definitions,
     constants, global variables and function prototypes that are
     only visible within the kernel. The functions include 
-    generic table routines. 
+    query file information routines. 
 
 Environment:
 
@@ -24,7 +24,6 @@ Environment:
 #define AV_STRING_TAG                        'tSvA'
 #define AV_RESOURCE_TAG                      'cRvA'
 #define AV_KEVENT_TAG                        'eKvA'
-#define AV_TABLE_ENTRY_TAG                   'eTvA'
 
 //////////////////////////////////////////////////////////////////////////////
 //  ReFS Compatibility Helpers                                              //
@@ -54,62 +53,6 @@ typedef union _AV_FILE_REFERENCE {
 } AV_FILE_REFERENCE, *PAV_FILE_REFERENCE;
 
 
-//
-//  The generic table entry data structure.
-//
-
-typedef struct _AV_GENERIC_TABLE_ENTRY {
-    
-    AV_FILE_REFERENCE FileId;
-    ULONG      InfectedState;
-
-    //
-    // Revision numbers for files on CSVFS
-    //
-    LONGLONG   VolumeRevision;
-    LONGLONG   CacheRevision;
-    LONGLONG   FileRevision;
-    
-} AV_GENERIC_TABLE_ENTRY, *PAV_GENERIC_TABLE_ENTRY;
-
-#define AV_GENERIC_TABLE_ENTRY_SIZE         sizeof( AV_GENERIC_TABLE_ENTRY )
-
-/*
-_IRQL_requires_same_
-_Function_class_(RTL_GENERIC_COMPARE_ROUTINE)
-RTL_GENERIC_COMPARE_RESULTS
-AvCompareEntry (
-    _In_ PRTL_GENERIC_TABLE Table,
-    _In_ PVOID FirstStruct,
-    _In_ PVOID SecondStruct
-    );
-
-_IRQL_requires_same_
-__drv_allocatesMem(Mem)
-_Function_class_(RTL_GENERIC_ALLOCATE_ROUTINE)
-PVOID
-NTAPI
-AvAllocateGenericTableEntry (
-    _In_ PRTL_GENERIC_TABLE Table,
-    _In_ CLONG ByteSize
-    );
-    
-_IRQL_requires_same_
-_Function_class_(RTL_GENERIC_FREE_ROUTINE)    
-VOID
-NTAPI
-AvFreeGenericTableEntry (
-    _In_ PRTL_GENERIC_TABLE Table,
-    _In_ __drv_freesMem(Mem) _Post_invalid_ PVOID Entry
-    );
-*/
-
-RTL_GENERIC_COMPARE_ROUTINE AvCompareEntry;
-
-RTL_GENERIC_ALLOCATE_ROUTINE AvAllocateGenericTableEntry;
-
-RTL_GENERIC_FREE_ROUTINE AvFreeGenericTableEntry;
-
 //
 // NTFS supports a file state cache. Since CSVFS is built on top of
 // NTFS, it can also support the cache. 
@@ -186,6 +129,13 @@ AvGetFileSize (
     _In_    PFILE_OBJECT FileObject,
     _Out_   PLONGLONG Size
     );
+
+NTSTATUS
+AvGetFileUsn (
+    _In_    PFLT_INSTANCE Instance,
+    _In_    PFILE_OBJECT FileObject,
+    _Out_   PUSN Usn
+    );
     
 NTSTATUS
 AvGetFileEncrypted (
@@ -51,7 +51,9 @@ typedef enum _AVSCAN_COMMAND {
 
     AvIsFileModified,
     AvCmdCreateSectionForDataScan,
-    AvCmdCloseSectionForDataScan
+    AvCmdCloseSectionForDataScan,
+    AvCmdQueryCacheStatistics,
+    AvCmdCreateSectionsForDataScan
 
 } AVSCAN_COMMAND;
 
@@ -123,10 +125,71 @@ typedef struct _COMMAND_MESSAGE {
         //  Valid when Command == AvCmdCloseSectionForDataScan
         //
         AVSCAN_RESULT ScanResult;
+
+        //
+        //  The number of scan identifiers that follow in
+        //  COMMAND_BATCH_MESSAGE.
+        //  Valid when Command == AvCmdCreateSectionsForDataScan
+        //
+        ULONG BatchCount;
     };
     
 } COMMAND_MESSAGE, *PCOMMAND_MESSAGE;
 
+//
+//  The maximum number of scans whose sections can be created with a
+//  single AvCmdCreateSectionsForDataScan command.
+//
+
+#define AV_SECTION_BATCH_MAX    16
+
+//
+//  AvCmdCreateSectionsForDataScan creates the sections for several pending
+//  scans in one round trip. Header.ScanId is not used; the scans are named
+//  by the first Header.BatchCount entries of ScanIds.
+//
+
+typedef struct _COMMAND_BATCH_MESSAGE {
+
+    COMMAND_MESSAGE  Header;
+
+    LONGLONG  ScanIds[AV_SECTION_BATCH_MAX];
+
+} COMMAND_BATCH_MESSAGE, *PCOMMAND_BATCH_MESSAGE;
+
+//
+//  The output of AvCmdCreateSectionsForDataScan, one entry per scan in
+//  the order they were requested. SectionHandle is only valid when Status
+//  is a success code, and must then be closed by the caller just like the
+//  handle returned by AvCmdCreateSectionForDataScan. A failed entry has
+//  already been completed by the filter and must not be closed.
+//
+
+typedef struct _AV_SECTION_BATCH_ENTRY {
+
+    HANDLE  SectionHandle;
+
+    LONG    Status;
+
+} AV_SECTION_BATCH_ENTRY, *PAV_SECTION_BATCH_ENTRY;
+
+//
+//  The maximum number of byte ranges a scan can be limited to.
+//
+
+#define AV_SCAN_RANGE_MAX       8
+
+//
+//  A byte range of the file to be scanned.
+//
+
+typedef struct _AV_SCAN_RANGE {
+
+    LONGLONG  Offset;
+    LONGLONG  Length;
+
+} AV_SCAN_RANGE, *PAV_SCAN_RANGE;
+
 //
 //  Message: Kernel -> User Message
 //
@@ -158,9 +221,39 @@ typedef struct _SCANNER_NOTIFICATION {
     //
     
     ULONG  ScanThreadId;
+
+    //
+    //  When the file was clean before it was last written, only the 
+    //  first RangeCount entries of Ranges need to be scanned. 
+    //  A RangeCount of 0 means the whole file must be scanned.
+    //  Valid when Message == AvMsgStartScanning
+    //
+
+    ULONG  RangeCount;
+
+    AV_SCAN_RANGE  Ranges[AV_SCAN_RANGE_MAX];
     
 } AV_SCANNER_NOTIFICATION, *PAV_SCANNER_NOTIFICATION;
 
+//
+//  The file state cache counters returned for AvCmdQueryCacheStatistics.
+//
+//  Hits counts every lookup that found the file; StaleHits counts those
+//  that were then discarded because the file had changed, so the useful
+//  hit ratio is (Hits - StaleHits) / Lookups.
+//
+
+typedef struct _AV_CACHE_STATISTICS {
+
+    ULONGLONG Lookups;
+    ULONGLONG Hits;
+    ULONGLONG StaleHits;
+    ULONGLONG Updates;
+    ULONGLONG Invalidations;
+    ULONGLONG Evictions;
+
+} AV_CACHE_STATISTICS, *PAV_CACHE_STATISTICS;
+
 //
 //  Connection type enumeration. It would be mainly used in connection context.
 //
@@ -17,6 +17,11 @@ Abstract:
     Before the user types 'q' to quit this program, the scan 
     threads will continue to work.
 
+    Usage: avscan [WorkerCount]
+
+    WorkerCount is the number of scanning worker threads; it 
+    defaults to the number of processors.
+
 Environment:
 
     User mode
@@ -25,6 +30,7 @@ Environment:
 
 #include <windows.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <fltUser.h>
 #include "utility.h"
 #include "avlib.h"
@@ -32,8 +38,8 @@ Environment:
 
 int _cdecl
 main (
-    _Unreferenced_parameter_ int argc,
-    _Unreferenced_parameter_ char *argv[]
+    _In_ int argc,
+    _In_reads_(argc) char *argv[]
     )
 /*++
 
@@ -58,9 +64,10 @@ Return Value:
     HRESULT hr = S_OK;
     USER_SCAN_CONTEXT userScanCtx = {0};
 
-    UNREFERENCED_PARAMETER( argc );
-    UNREFERENCED_PARAMETER( argv );
+    if (argc > 1) {
 
+        userScanCtx.WorkerCount = strtoul( argv[1], NULL, 10 );
+    }
     
     //
     //  Initialize scan listening threads.
@@ -79,12 +86,17 @@ Return Value:
     
     for(;;) {
     
-        printf("press 'q' to quit: ");
+        printf("press 's' for cache statistics, 'q' to quit: ");
         c = (unsigned char) getchar();
         if (c == 'q') {
         
             break;
         }
+
+        if (c == 's') {
+
+            UserScanPrintCacheStatistics(&userScanCtx);
+        }
     }
     
     //
@@ -27,7 +27,19 @@ Environment:
 #include "userscan.h"
 #include "utility.h"
 
-#define  USER_SCAN_THREAD_COUNT   6      // the number of scanning worker threads.
+#define  USER_SCAN_LISTEN_THREAD_COUNT   2      // the number of threads receiving scan messages.
+
+//
+//  All the threads are waited on together with WaitForMultipleObjects(...)
+//
+
+#define  USER_SCAN_MAX_WORKER_COUNT      (MAXIMUM_WAIT_OBJECTS - USER_SCAN_LISTEN_THREAD_COUNT)
+
+//
+//  Each listening thread keeps enough messages pending to fill a batch.
+//
+
+#define  USER_SCAN_MESSAGE_COUNT         (USER_SCAN_LISTEN_THREAD_COUNT * AV_SECTION_BATCH_MAX)
 
 typedef struct _SCANNER_MESSAGE {
 
@@ -74,6 +86,29 @@ typedef struct _SCANNER_REPLY_MESSAGE {
 
 #define SCANNER_REPLY_MESSAGE_SIZE   (sizeof(FILTER_REPLY_HEADER) + sizeof(ULONG))
 
+//
+//  A scan whose section has been created, queued from a listening thread
+//  to the scanning workers through USER_SCAN_CONTEXT::ScanQueue.
+//
+
+typedef struct _SCANNER_REQUEST {
+
+    LONGLONG       ScanId;
+
+    HANDLE         SectionHandle;
+
+    AVSCAN_REASON  Reason;
+
+    //
+    //  The ranges to scan, a RangeCount of 0 scans the whole section.
+    //
+
+    ULONG          RangeCount;
+
+    AV_SCAN_RANGE  Ranges[AV_SCAN_RANGE_MAX];
+
+} SCANNER_REQUEST, *PSCANNER_REQUEST;
+
 //
 //  Local routines
 //
@@ -85,13 +120,33 @@ UserScanMemoryStream(
     _Inout_                   PBOOLEAN pAbort
     );
     
+HRESULT
+UserScanCloseSection (
+    _In_  PUSER_SCAN_CONTEXT Context,
+    _In_  LONGLONG ScanId,
+    _In_  HANDLE SectionHandle,
+    _In_  AVSCAN_RESULT ScanResult
+    );
+
+HRESULT
+UserScanCreateSections (
+    _In_     PUSER_SCAN_CONTEXT Context,
+    _Inout_  PCOMMAND_BATCH_MESSAGE Batch,
+    _In_reads_(AV_SECTION_BATCH_MAX)  PAV_SCANNER_NOTIFICATION *Notifications
+    );
+    
 HRESULT 
-UserScanHandleStartScanMsg(
+UserScanHandleScanRequest(
     _In_  PUSER_SCAN_CONTEXT Context,
-    _In_  PSCANNER_MESSAGE Message,
+    _In_  PSCANNER_REQUEST Request,
     _In_  PSCANNER_THREAD_CONTEXT ThreadCtx
     );
     
+HRESULT
+UserScanListener (
+    _Inout_ PUSER_SCAN_CONTEXT Context
+    );
+    
 HRESULT
 UserScanWorker (
     _Inout_ PUSER_SCAN_CONTEXT Context
@@ -104,7 +159,8 @@ UserScanListenAbortProc (
     
 DWORD
 WaitForAll (
-    _In_  PSCANNER_THREAD_CONTEXT  ScanThreadCtxes
+    _In_reads_(ThreadCount)  PSCANNER_THREAD_CONTEXT  ScanThreadCtxes,
+    _In_  ULONG  ThreadCount
     );
 
 HRESULT
@@ -114,6 +170,13 @@ UserScanGetThreadContextById (
     _Out_ PSCANNER_THREAD_CONTEXT  *ScanThreadCtx
     );
 
+HRESULT
+UserScanGetThreadContextByScanId (
+    _In_  LONGLONG ScanId,
+    _In_  PUSER_SCAN_CONTEXT Context,
+    _Out_ PSCANNER_THREAD_CONTEXT  *ScanThreadCtx
+    );
+
 VOID
 UserScanSynchronizedCancel (
     _In_  PUSER_SCAN_CONTEXT Context
@@ -142,7 +205,8 @@ UserScanInit (
 
 Routine Description:
 
-    This routine initializes all the necessary data structures and forks listening threads.
+    This routine initializes all the necessary data structures and forks listening threads
+    and Context->WorkerCount scanning worker threads.
     The caller thread is responsible for calling UserScanFinalize(...) to cleanup the 
     data structures and close the listening threads.
 
@@ -158,15 +222,34 @@ Return Value:
 {
     HRESULT  hr = S_OK;
     ULONG    i = 0;
+    ULONG    threadCount = 0;
     HANDLE   hEvent = NULL;
     PSCANNER_THREAD_CONTEXT  scanThreadCtxes = NULL;
     HANDLE   hListenAbort = NULL;
     AV_CONNECTION_CONTEXT connectionCtx = {0};
+    SYSTEM_INFO systemInfo;
     
     if (NULL == Context) {
     
         return MAKE_HRESULT(SEVERITY_ERROR, 0, E_POINTER);
     }
+
+    //
+    //  By default scan on one worker per processor.
+    //
+
+    if (0 == Context->WorkerCount) {
+
+        GetSystemInfo( &systemInfo );
+        Context->WorkerCount = systemInfo.dwNumberOfProcessors;
+    }
+
+    if (Context->WorkerCount > USER_SCAN_MAX_WORKER_COUNT) {
+
+        Context->WorkerCount = USER_SCAN_MAX_WORKER_COUNT;
+    }
+
+    threadCount = USER_SCAN_LISTEN_THREAD_COUNT + Context->WorkerCount;
     
     //
     //  Create the abort listening thead.
@@ -190,26 +273,28 @@ Return Value:
     //  Initialize scan thread contexts.
     //
     
-    scanThreadCtxes = HeapAlloc(GetProcessHeap(), 0, sizeof(SCANNER_THREAD_CONTEXT) * USER_SCAN_THREAD_COUNT);
+    scanThreadCtxes = HeapAlloc(GetProcessHeap(), 0, sizeof(SCANNER_THREAD_CONTEXT) * threadCount);
     if (NULL == scanThreadCtxes) {
     
         hr = MAKE_HRESULT(SEVERITY_ERROR, 0, E_OUTOFMEMORY);
         goto Cleanup;
     }
     
-    ZeroMemory(scanThreadCtxes, sizeof(SCANNER_THREAD_CONTEXT) * USER_SCAN_THREAD_COUNT);
+    ZeroMemory(scanThreadCtxes, sizeof(SCANNER_THREAD_CONTEXT) * threadCount);
     
     //
-    //  Create scan listening threads.
+    //  Create scan listening threads followed by the scanning workers.
     //
     
     for (i = 0;
-         i < USER_SCAN_THREAD_COUNT;
+         i < threadCount;
          i ++ ) {
          
         scanThreadCtxes[i].Handle = CreateThread( NULL,
                                                   0,
-                                                  (LPTHREAD_START_ROUTINE)UserScanWorker,
+                                                  (i < USER_SCAN_LISTEN_THREAD_COUNT) ?
+                                                    (LPTHREAD_START_ROUTINE)UserScanListener :
+                                                    (LPTHREAD_START_ROUTINE)UserScanWorker,
                                                   Context,
                                                   CREATE_SUSPENDED,
                                                   &scanThreadCtxes[i].ThreadId );
@@ -245,14 +330,31 @@ Return Value:
     Context->Completion = CreateIoCompletionPort( Context->ConnectionPort,
                                                   NULL,
                                                   0,
-                                                  USER_SCAN_THREAD_COUNT );
+                                                  USER_SCAN_LISTEN_THREAD_COUNT );
     
     if ( NULL == Context->Completion ) {
         hr = HRESULT_FROM_WIN32(GetLastError());
         goto Cleanup;
     }
+
+    //
+    //  Create the IO completion port used as the scan request queue.
+    //  It is not associated with any file; the listening threads post
+    //  requests to it and the scanning workers dequeue them.
+    //
+
+    Context->ScanQueue = CreateIoCompletionPort( INVALID_HANDLE_VALUE,
+                                                 NULL,
+                                                 0,
+                                                 Context->WorkerCount );
+    
+    if ( NULL == Context->ScanQueue ) {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        goto Cleanup;
+    }
     
     Context->ScanThreadCtxes = scanThreadCtxes;
+    Context->ThreadCount = threadCount;
     Context->AbortThreadHandle = hListenAbort;
     
     //
@@ -260,7 +362,7 @@ Return Value:
     //
     
     for (i = 0;
-         i < USER_SCAN_THREAD_COUNT;
+         i < threadCount;
          i ++ ) {
          if ( ResumeThread( scanThreadCtxes[i].Handle ) == -1) {
          
@@ -285,7 +387,7 @@ Return Value:
     //
     
     for (i = 0;
-         i < USER_SCAN_THREAD_COUNT;
+         i < USER_SCAN_MESSAGE_COUNT;
          i ++ ) {
 
         PSCANNER_MESSAGE msg = HeapAlloc( GetProcessHeap(), 0, sizeof( SCANNER_MESSAGE ) );
@@ -319,6 +421,11 @@ Return Value:
     
 Cleanup:
 
+    if (Context->ScanQueue && !CloseHandle(Context->ScanQueue)) {
+    
+        fprintf(stderr, "[UserScanInit] Error! Close scan queue failed.\n");
+        DisplayError(HRESULT_FROM_WIN32(GetLastError()));
+    }
     if (Context->Completion && !CloseHandle(Context->Completion)) {
     
         fprintf(stderr, "[UserScanInit] Error! Close completion port failed.\n");
@@ -332,7 +439,7 @@ Cleanup:
     if (scanThreadCtxes) {
     
         for (i = 0;
-         i < USER_SCAN_THREAD_COUNT;
+         i < threadCount;
          i ++ ) {
 
             if (scanThreadCtxes[i].Handle && !CloseHandle(scanThreadCtxes[i].Handle)) {
@@ -395,6 +502,64 @@ Return Value:
     return hr;
 }
 
+HRESULT
+UserScanPrintCacheStatistics (
+    _In_  PUSER_SCAN_CONTEXT Context
+    )
+/*++
+
+Routine Description:
+
+    This routine queries the filter's file state cache counters and prints
+    them along with the hit ratio.
+
+Arguments:
+
+    Context    - User scan context, please see userscan.h
+
+Return Value:
+
+    S_OK if successful. Otherwise, it returns a HRESULT error value.
+
+--*/
+{
+    HRESULT  hr = S_OK;
+    DWORD bytesReturned = 0;
+    COMMAND_MESSAGE commandMessage = {0};
+    AV_CACHE_STATISTICS statistics = {0};
+
+    commandMessage.Command = AvCmdQueryCacheStatistics;
+
+    hr = FilterSendMessage( Context->ConnectionPort,
+                            &commandMessage,
+                            sizeof( COMMAND_MESSAGE ),
+                            &statistics,
+                            sizeof( AV_CACHE_STATISTICS ),
+                            &bytesReturned );
+
+    if (FAILED(hr)) {
+
+        fprintf(stderr,
+          "[UserScanPrintCacheStatistics]: Failed to query the cache statistics.\n");
+        DisplayError(hr);
+        return hr;
+    }
+
+    printf("Cache lookups: %I64u, hits: %I64u, stale: %I64u, hit ratio: %.1f%%\n",
+           statistics.Lookups,
+           statistics.Hits,
+           statistics.StaleHits,
+           statistics.Lookups ?
+               100.0 * (statistics.Hits - statistics.StaleHits) / statistics.Lookups : 0.0);
+
+    printf("Cache updates: %I64u, invalidations: %I64u, evictions: %I64u\n",
+           statistics.Updates,
+           statistics.Invalidations,
+           statistics.Evictions);
+
+    return hr;
+}
+
 
 //
 //  Implementation of local routines
@@ -402,7 +567,8 @@ Return Value:
 
 DWORD
 WaitForAll (
-    _In_  PSCANNER_THREAD_CONTEXT  ScanThreadCtxes
+    _In_reads_(ThreadCount)  PSCANNER_THREAD_CONTEXT  ScanThreadCtxes,
+    _In_  ULONG  ThreadCount
     )
 /*++
 
@@ -414,6 +580,8 @@ Arguments:
 
     ScanThreadCtxes    - Scan thread contextes.
 
+    ThreadCount        - The number of scan thread contexts, at most MAXIMUM_WAIT_OBJECTS.
+
 Return Value:
     
     Please consult WaitForMultipleObjects(...)
@@ -421,13 +589,13 @@ Return Value:
 --*/
 {
     ULONG i = 0;
-    HANDLE hScanThreads[USER_SCAN_THREAD_COUNT] = {0};
+    HANDLE hScanThreads[MAXIMUM_WAIT_OBJECTS] = {0};
     for (i = 0;
-      i < USER_SCAN_THREAD_COUNT;
+      i < ThreadCount;
       i ++ ) {
       hScanThreads[i] = ScanThreadCtxes[i].Handle;
     }
-    return WaitForMultipleObjects(USER_SCAN_THREAD_COUNT, hScanThreads, TRUE, INFINITE);
+    return WaitForMultipleObjects(ThreadCount, hScanThreads, TRUE, INFINITE);
 }
 
 HRESULT
@@ -463,7 +631,7 @@ Return Value:
     *ScanThreadCtx = NULL;
     
     for (i = 0;
-         i < USER_SCAN_THREAD_COUNT;
+         i < Context->ThreadCount;
          i ++ ) {
         
         if ( ThreadId == scanThreadCtx[i].ThreadId ) {
@@ -474,6 +642,52 @@ Return Value:
     return MAKE_HRESULT(SEVERITY_ERROR,0,E_FAIL);
 }
 
+HRESULT
+UserScanGetThreadContextByScanId (
+    _In_  LONGLONG ScanId,
+    _In_  PUSER_SCAN_CONTEXT Context,
+    _Out_ PSCANNER_THREAD_CONTEXT  *ScanThreadCtx
+    )
+/*++
+
+Routine Description:
+
+    This routine search for the scanning worker that is scanning the given scan id.
+    The caller must re-check the scan id under the thread context lock, since the 
+    worker may move on to the next request at any time.
+
+Arguments:
+
+    ScanId    - The scan id to be searched.
+    
+    Context   - The user scan context.
+    
+    ScanThreadCtx  -  Output scan thread context.
+
+Return Value:
+    
+    S_OK if found, otherwise not found.
+    
+--*/
+{
+    HRESULT hr = S_OK;
+    ULONG i;
+    PSCANNER_THREAD_CONTEXT scanThreadCtx = Context->ScanThreadCtxes;
+    
+    *ScanThreadCtx = NULL;
+    
+    for (i = USER_SCAN_LISTEN_THREAD_COUNT;
+         i < Context->ThreadCount;
+         i ++ ) {
+        
+        if ( ScanId == scanThreadCtx[i].ScanId ) {
+            *ScanThreadCtx = (scanThreadCtx + i);
+            return hr;
+        }
+    }
+    return MAKE_HRESULT(SEVERITY_ERROR,0,E_FAIL);
+}
+
 VOID
 UserScanSynchronizedCancel (
     _In_  PUSER_SCAN_CONTEXT Context
@@ -513,25 +727,44 @@ Return Value:
     //
     
     for (i = 0;
-         i < USER_SCAN_THREAD_COUNT;
+         i < Context->ThreadCount;
          i ++ ) {
          
         scanThreadCtxes[i].Aborted = TRUE;
     }
     
     //
-    //  Wake up the listening thread if it is waiting for message 
-    //  via GetQueuedCompletionStatus() 
+    //  Wake up the listening threads if they are waiting for message 
+    //  via GetQueuedCompletionStatusEx(). A single thread may dequeue 
+    //  all of the cancelled messages, so wake each of them explicitly too.
     //
     
     CancelIoEx(Context->ConnectionPort, NULL);
+
+    for (i = 0;
+         i < USER_SCAN_LISTEN_THREAD_COUNT;
+         i ++ ) {
+
+        PostQueuedCompletionStatus( Context->Completion, 0, 0, NULL );
+    }
+
+    //
+    //  Queue one exit signal per scanning worker behind any pending requests.
+    //
+
+    for (i = 0;
+         i < Context->WorkerCount;
+         i ++ ) {
+
+        PostQueuedCompletionStatus( Context->ScanQueue, 0, 0, NULL );
+    }
     
     //
     //  Wait for all scan threads to complete cancellation, 
     //  so we will be able to close the connection port and etc.
     //
     
-    WaitForAll(scanThreadCtxes);
+    WaitForAll(scanThreadCtxes, Context->ThreadCount);
 
     return;
 }
@@ -571,6 +804,13 @@ Return Value:
     }
     
     Context->Completion = NULL;
+
+    if (!CloseHandle(Context->ScanQueue)) {
+       fprintf(stderr, "[UserScanFinalize]: Failed to close the scan queue.\n");
+       hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+    
+    Context->ScanQueue = NULL;
     
     return hr;
 }
@@ -619,7 +859,7 @@ Return Value:
     //
     
     for (i = 0;
-     i < USER_SCAN_THREAD_COUNT;
+     i < Context->ThreadCount;
      i ++ ) {
 
         if (scanThreadCtxes[i].Handle && !CloseHandle(scanThreadCtxes[i].Handle)) {
@@ -719,93 +959,235 @@ Return Value:
 }
 
 HRESULT
-UserScanHandleStartScanMsg(
+UserScanCloseSection (
     _In_  PUSER_SCAN_CONTEXT Context,
-    _In_  PSCANNER_MESSAGE Message,
-    _In_  PSCANNER_THREAD_CONTEXT ThreadCtx
+    _In_  LONGLONG ScanId,
+    _In_  HANDLE SectionHandle,
+    _In_  AVSCAN_RESULT ScanResult
     )
 /*++
 
 Routine Description:
 
-    After receiving the scan request from the kernel. This routine is 
-    the main function that handle the scan request.
+    This routine closes the section handle of a scan and sends the message 
+    to tell the filter to close the section object.
 
-    This routine does not know which file it is scanning because it 
-    does not need to know.
-
-    Its main job includes:
-
-    1) Send message to the filter to create a section object.
-    2) Map the view of the section.
-    3) Scan the memory
-    4) Send message to tell the filter the result of the scan
-       and close the section object.
+    This call will set the file clean or infected depending on the scan result, and 
+    also trigger events and release the waiting I/O request thread.
 
 Arguments:
 
     Context   - The user scan context.
 
-    Message  -  The message recieved from the kernel.
+    ScanId    - The scan id obtained from the filter.
 
-    ThreadCtx - The scan thread context.
+    SectionHandle - The section handle created by the filter for this scan.
+
+    ScanResult - The result of the scan.
 
 Return Value:
 
-    S_OK.
+    S_OK if successful. Otherwise, it returns a HRESULT error value.
 
 --*/
 {
     HRESULT  hr = S_OK;
     ULONG    bytesReturned = 0;
-    HANDLE   sectionHandle = NULL;
-    DWORD    dwErrCode = 0;
-    PVOID    scanAddress = NULL;
-    MEMORY_BASIC_INFORMATION memoryInfo;
-    PAV_SCANNER_NOTIFICATION notification = &Message->Notification;
-    COMMAND_MESSAGE          commandMessage = {0};
-    DWORD flags = 0;
+    COMMAND_MESSAGE commandMessage = {0};
 
     //
-    //  Send the message to the filter to create a section object for data scan.
-    //  If success, we would get section handle.
-    //
-    //  We just have to transparently pass ScanContextId to filter, which we 
-    //  obtained from the filter previously.
+    //  We have to close the section handle after we finish using it.
+    //  It is required to close the section handle here in user mode.
     //
 
-    commandMessage.Command = AvCmdCreateSectionForDataScan;
-    commandMessage.ScanId = notification->ScanId;
-    commandMessage.ScanThreadId = ThreadCtx->ThreadId;
+    if (!CloseHandle(SectionHandle)) {
+
+        fprintf(stderr, "[UserScanCloseSection]: Failed to close the section handle.\n");
+        DisplayError(HRESULT_FROM_WIN32(GetLastError()));
+    }
+
+    commandMessage.Command = AvCmdCloseSectionForDataScan;
+    commandMessage.ScanId = ScanId;
+    commandMessage.ScanThreadId = GetCurrentThreadId();
+    commandMessage.ScanResult = ScanResult;
 
     hr = FilterSendMessage( Context->ConnectionPort,
                             &commandMessage,
                             sizeof( COMMAND_MESSAGE ),
-                            &sectionHandle,
-                            sizeof( HANDLE ),
+                            NULL,
+                            0,
+                            &bytesReturned );
+    if (FAILED(hr)) {
+
+        fprintf(stderr,
+          "[UserScanCloseSection]: Failed to close message SendMessageToCreateSection to the minifilter.\n");
+        DisplayError( hr );
+    }
+
+    return hr;
+}
+
+HRESULT
+UserScanCreateSections (
+    _In_     PUSER_SCAN_CONTEXT Context,
+    _Inout_  PCOMMAND_BATCH_MESSAGE Batch,
+    _In_reads_(AV_SECTION_BATCH_MAX)  PAV_SCANNER_NOTIFICATION *Notifications
+    )
+/*++
+
+Routine Description:
+
+    This routine asks the filter to create the section objects for a batch
+    of scan requests with a single message, and queues one scan request per
+    section to the scanning workers.
+
+    We just have to transparently pass the scan ids to filter, which we 
+    obtained from the filter previously.
+
+Arguments:
+
+    Context   - The user scan context.
+
+    Batch     - The batch command. Header.BatchCount and ScanIds must be set.
+
+    Notifications - The scan notification of each scan in the batch.
+
+Return Value:
+
+    S_OK if the message was sent. Otherwise, it returns a HRESULT error value.
+
+--*/
+{
+    HRESULT  hr = S_OK;
+    ULONG    bytesReturned = 0;
+    ULONG    i = 0;
+    PSCANNER_REQUEST request = NULL;
+    AV_SECTION_BATCH_ENTRY entries[AV_SECTION_BATCH_MAX];
+
+    Batch->Header.Command = AvCmdCreateSectionsForDataScan;
+    Batch->Header.ScanThreadId = GetCurrentThreadId();
+
+    hr = FilterSendMessage( Context->ConnectionPort,
+                            Batch,
+                            sizeof( COMMAND_BATCH_MESSAGE ),
+                            entries,
+                            Batch->Header.BatchCount * sizeof( AV_SECTION_BATCH_ENTRY ),
                             &bytesReturned );
 
     if (FAILED(hr)) {
 
         fprintf(stderr,
-          "[UserScanHandleStartScanMsg]: Failed to send message SendMessageToCreateSection to the minifilter.\n");
+          "[UserScanCreateSections]: Failed to send message SendMessageToCreateSections to the minifilter.\n");
         DisplayError(hr);
         return hr;
     }
 
-    scanAddress = MapViewOfFile( sectionHandle,
+    for (i = 0;
+         i < Batch->Header.BatchCount;
+         i ++ ) {
+
+        //
+        //  A negative status is a failure NTSTATUS. The filter has already
+        //  released the waiting I/O request thread for such a scan.
+        //
+
+        if (entries[i].Status < 0) {
+
+            continue;
+        }
+
+        request = HeapAlloc( GetProcessHeap(), 0, sizeof( SCANNER_REQUEST ) );
+
+        if (NULL != request) {
+
+            request->ScanId = Batch->ScanIds[i];
+            request->SectionHandle = entries[i].SectionHandle;
+            request->Reason = Notifications[i]->Reason;
+            request->RangeCount = min( Notifications[i]->RangeCount, AV_SCAN_RANGE_MAX );
+            CopyMemory( request->Ranges,
+                        Notifications[i]->Ranges,
+                        request->RangeCount * sizeof( AV_SCAN_RANGE ) );
+
+            if (PostQueuedCompletionStatus( Context->ScanQueue, 0, (ULONG_PTR)request, NULL )) {
+
+                continue;
+            }
+
+            HeapFree( GetProcessHeap(), 0, request );
+        }
+
+        //
+        //  We could not queue this scan, so give the section back right away
+        //  rather than let the I/O request thread wait for its timeout.
+        //
+
+        fprintf(stderr, "[UserScanCreateSections]: Failed to queue scan %lld.\n", Batch->ScanIds[i]);
+        UserScanCloseSection( Context,
+                              Batch->ScanIds[i],
+                              entries[i].SectionHandle,
+                              AvScanResultUndetermined );
+    }
+
+    return S_OK;
+}
+
+HRESULT
+UserScanHandleScanRequest(
+    _In_  PUSER_SCAN_CONTEXT Context,
+    _In_  PSCANNER_REQUEST Request,
+    _In_  PSCANNER_THREAD_CONTEXT ThreadCtx
+    )
+/*++
+
+Routine Description:
+
+    This routine is the main function that handle a queued scan request.
+
+    This routine does not know which file it is scanning because it 
+    does not need to know.
+
+    Its main job includes:
+
+    1) Map the view of the section the filter created for this scan.
+    2) Scan the memory, or only the ranges the filter asked for if the
+       file was clean before it was written.
+    3) Send message to tell the filter the result of the scan
+       and close the section object.
+
+Arguments:
+
+    Context   - The user scan context.
+
+    Request   - The scan request queued by a listening thread.
+
+    ThreadCtx - The scan thread context.
+
+Return Value:
+
+    S_OK if successful. Otherwise, it returns a HRESULT error value.
+
+--*/
+{
+    PVOID    scanAddress = NULL;
+    MEMORY_BASIC_INFORMATION memoryInfo;
+    AVSCAN_RESULT scanResult = AvScanResultUndetermined;
+    DWORD flags = 0;
+    ULONG i = 0;
+    PAV_SCAN_RANGE range = NULL;
+
+    scanAddress = MapViewOfFile( Request->SectionHandle,
                                  FILE_MAP_READ,
                                  0L,
                                  0L,
                                  0 );
     if (scanAddress == NULL) {
-        fprintf(stderr, "[UserScanHandleStartScanMsg]: Failed to map the view.\n");
+        fprintf(stderr, "[UserScanHandleScanRequest]: Failed to map the view.\n");
         DisplayError(HRESULT_FROM_WIN32(GetLastError()));
         goto Cleanup;
     }
 
     if( !VirtualQuery( scanAddress, &memoryInfo, sizeof(memoryInfo) )) {
-        fprintf(stderr, "[UserScanHandleStartScanMsg]: Failed to query the view.\n");
+        fprintf(stderr, "[UserScanHandleScanRequest]: Failed to query the view.\n");
         DisplayError(HRESULT_FROM_WIN32(GetLastError()));
         goto Cleanup;
     }
@@ -814,9 +1196,37 @@ Return Value:
     //  Data scan here.
     //
 
-    commandMessage.ScanResult = UserScanMemoryStream( (PUCHAR)scanAddress, 
-                                                       memoryInfo.RegionSize,
-                                                       &ThreadCtx->Aborted );
+    if (0 == Request->RangeCount) {
+
+        scanResult = UserScanMemoryStream( (PUCHAR)scanAddress, 
+                                           memoryInfo.RegionSize,
+                                           &ThreadCtx->Aborted );
+    } else {
+
+        //
+        //  The file may have been truncated since the ranges were recorded.
+        //
+
+        scanResult = AvScanResultClean;
+
+        for (i = 0;
+             (i < Request->RangeCount) && (scanResult == AvScanResultClean);
+             i ++ ) {
+
+            range = &Request->Ranges[i];
+
+            if ((range->Offset < 0) ||
+                ((ULONGLONG)range->Offset >= memoryInfo.RegionSize)) {
+
+                continue;
+            }
+
+            scanResult = UserScanMemoryStream( (PUCHAR)scanAddress + (SIZE_T)range->Offset, 
+                                               (SIZE_T)min( (ULONGLONG)range->Length,
+                                                            (ULONGLONG)memoryInfo.RegionSize - range->Offset ),
+                                               &ThreadCtx->Aborted );
+        }
+    }
 
     //
     //  If scanning on file open, give the pages a transient boost
@@ -824,7 +1234,7 @@ Return Value:
     //  file. 
     //
 
-    if (notification->Reason == AvScanOnOpen) {
+    if (Request->Reason == AvScanOnOpen) {
         flags = MEM_UNMAP_WITH_TRANSIENT_BOOST;
     }
 
@@ -834,63 +1244,39 @@ Cleanup:
 
         if (!UnmapViewOfFileEx( scanAddress, flags )) {
 
-            fprintf(stderr, "[UserScanHandleStartScanMsg]: Failed to unmap the view.\n");
+            fprintf(stderr, "[UserScanHandleScanRequest]: Failed to unmap the view.\n");
             DisplayError(HRESULT_FROM_WIN32(GetLastError()));
         }
     }
 
-    //
-    //  We have to close the section handle after we finish using it.
-    //  It is required to close the section handle here in user mode.
-    //
-
-    if (!CloseHandle(sectionHandle)) {
-
-        fprintf(stderr, "[UserScanHandleStartScanMsg]: Failed to close the section handle.\n");
-        DisplayError(HRESULT_FROM_WIN32(dwErrCode));
-    }
-
-    //
-    //  Send the message to tell filter to close the section object.
-    //  This call will set the file clean or infected depending on the scan result, and 
-    //  also trigger events and release the waiting I/O request thread.
-    //
-
-    commandMessage.Command = AvCmdCloseSectionForDataScan;
-    hr = FilterSendMessage( Context->ConnectionPort,
-                            &commandMessage,
-                            sizeof( COMMAND_MESSAGE ),
-                            NULL,
-                            0,
-                            &bytesReturned );
-    if (FAILED(hr)) {
-
-        fprintf(stderr,
-          "[UserScanHandleStartScanMsg]: Failed to close message SendMessageToCreateSection to the minifilter.\n");
-        DisplayError( hr );
-        return hr;
-    }
-
-    return hr;
+    return UserScanCloseSection( Context,
+                                 Request->ScanId,
+                                 Request->SectionHandle,
+                                 scanResult );
 }
 
 HRESULT
-UserScanWorker (
+UserScanListener (
     _Inout_   PUSER_SCAN_CONTEXT Context
     )
 /*++
 
 Routine Description:
 
-    This routine is the scanning worker thread procedure.
+    This routine is the scan listening thread procedure.
     The pseudo-code of this function is as follows,
     
     while(TRUE) {
-        1) Get a overlap structure from the completion port.
-        2) Obtain message from overlap structure.
-        3) Process the message via calling UserScanHandleStartScanMsg(...)
-        4) Pump overlap structure into completion port using FilterGetMessage(...)
+        1) Get up to AV_SECTION_BATCH_MAX overlap structures from the completion port.
+        2) Obtain messages from overlap structures and reply our thread id to each.
+        3) Create the sections for all of them via UserScanCreateSections(...),
+           which queues the scan requests to the scanning workers.
+        4) Pump overlap structures into completion port using FilterGetMessage(...)
     }
+
+    Handing the scans off to the workers keeps the messages flowing while
+    files are being scanned, and batching the section creation means a burst
+    of scan requests costs one round trip to the filter per batch.
     
 Arguments:
 
@@ -905,11 +1291,15 @@ Return Value:
     HRESULT hr = S_OK;
     
     PSCANNER_MESSAGE  message = NULL;
+    PSCANNER_MESSAGE  messages[AV_SECTION_BATCH_MAX];
+    OVERLAPPED_ENTRY  entries[AV_SECTION_BATCH_MAX];
+    PAV_SCANNER_NOTIFICATION notifications[AV_SECTION_BATCH_MAX];
+    COMMAND_BATCH_MESSAGE batch;
     SCANNER_REPLY_MESSAGE replyMsg;
-    LPOVERLAPPED pOvlp = NULL;
     
-    DWORD outSize;
-    ULONG_PTR key;
+    ULONG entryCount = 0;
+    ULONG messageCount = 0;
+    ULONG i = 0;
     BOOL  success = FALSE;
     
     PSCANNER_THREAD_CONTEXT threadCtx = NULL;
@@ -917,28 +1307,32 @@ Return Value:
     hr = UserScanGetThreadContextById( GetCurrentThreadId(), Context, &threadCtx );
     if (FAILED(hr)) {
         fprintf(stderr,
-          "[UserScanWorker]: Failed to get thread context.\n");
+          "[UserScanListener]: Failed to get thread context.\n");
         return hr;
     }
     
-    ZeroMemory( &replyMsg, SCANNER_REPLY_MESSAGE_SIZE );
-   
-    printf("Current thread handle %p, id:%u\n", threadCtx->Handle, threadCtx->ThreadId);
+    printf("Current listening thread handle %p, id:%u\n", threadCtx->Handle, threadCtx->ThreadId);
     
     //
     //  This thread is waiting for scan message from the driver
     //
     
-   for(;;) {
+    for(;;) {
 
-        message = NULL;
+        messageCount = 0;
+        ZeroMemory( &batch, sizeof( COMMAND_BATCH_MESSAGE ) );
         
         //
-        //  Get overlapped structure asynchronously, the overlapped structure 
-        //  was previously pumped by FilterGetMessage(...)
+        //  Get overlapped structures asynchronously, the overlapped structures 
+        //  were previously pumped by FilterGetMessage(...)
         //
         
-        success = GetQueuedCompletionStatus( Context->Completion, &outSize, &key, &pOvlp, INFINITE );
+        success = GetQueuedCompletionStatusEx( Context->Completion,
+                                               entries,
+                                               AV_SECTION_BATCH_MAX,
+                                               &entryCount,
+                                               INFINITE,
+                                               FALSE );
         
         if (!success) {
         
@@ -947,7 +1341,7 @@ Return Value:
             //
             //  The completion port handle associated with it is closed 
             //  while the call is outstanding, the function returns FALSE, 
-            //  *lpOverlapped will be NULL, and GetLastError will return ERROR_ABANDONED_WAIT_0
+            //  and GetLastError will return ERROR_ABANDONED_WAIT_0
             //
             
             if (hr == E_HANDLE) {
@@ -964,33 +1358,53 @@ Return Value:
             break;
         }
         
-        //
-        //  Recover message strcuture from overlapped structure.
-        //  Remember we embedded overlapped structure inside SCANNER_MESSAGE.
-        //  This is because the overlapped structure obtained from GetQueuedCompletionStatus(...)
-        //  is asynchronously and not guranteed in order. 
-        //
-        
-        message = CONTAINING_RECORD( pOvlp, SCANNER_MESSAGE, Ovlp );
+        for (i = 0;
+             i < entryCount;
+             i ++ ) {
+
+            //
+            //  UserScanSynchronizedCancel(...) posts an empty completion to
+            //  wake us up.
+            //
+
+            if (NULL == entries[i].lpOverlapped) {
+
+                continue;
+            }
         
-        if (AvMsgStartScanning == message->Notification.Message) {
+            //
+            //  Recover message strcuture from overlapped structure.
+            //  Remember we embedded overlapped structure inside SCANNER_MESSAGE.
+            //  This is because the overlapped structure obtained from GetQueuedCompletionStatusEx(...)
+            //  is asynchronously and not guranteed in order. 
+            //
+            
+            message = CONTAINING_RECORD( entries[i].lpOverlapped, SCANNER_MESSAGE, Ovlp );
 
             //
-            //  Reset the abort flag since this is a new scan request and remember 
-            //  the scan context ID. This ID will allow us to match a cancel request 
-            //  with a given scan task.
+            //  A cancelled or failed FilterGetMessage(...) completes here as well,
+            //  with a failure status; its buffer holds no message.
             //
 
-            EnterCriticalSection(&(threadCtx->Lock));
-            threadCtx->Aborted = FALSE;
-            threadCtx->ScanId = message->Notification.ScanId;
-            LeaveCriticalSection(&(threadCtx->Lock));
+            if (0 != entries[i].lpOverlapped->Internal) {
+
+                HeapFree(GetProcessHeap(), 0, message);
+                continue;
+            }
+
+            messages[messageCount++] = message;
+            
+            if (AvMsgStartScanning != message->Notification.Message) {
+            
+                assert( FALSE ); // This thread should not receive other kinds of message.
+                continue;
+            }
         
             //
-            //  Reply the scanning worker thread handle to the filter
-            //  This is important because the filter will also wait for the scanning thread 
-            //  in case that the scanning thread is killed before telling filter 
-            //  the scan is done or aborted.
+            //  Reply our thread id to the filter. This is important because the 
+            //  filter will wait for the scan to complete and send us an abort 
+            //  notification if it times out. The abort is matched against the 
+            //  scan id, so it does not matter which worker ends up scanning.
             //
             
             ZeroMemory( &replyMsg, SCANNER_REPLY_MESSAGE_SIZE );
@@ -1002,23 +1416,30 @@ Return Value:
     
             if (FAILED(hr)) {
 
+                //
+                //  The filter gave up waiting for the reply, so it is no longer
+                //  expecting this scan.
+                //
+
                 fprintf(stderr,
-                  "[UserScanWorker]: Failed to reply thread handle to the minifilter\n");
+                  "[UserScanListener]: Failed to reply thread handle to the minifilter\n");
                 DisplayError(hr);
-                break;
+                continue;
             }
-            hr = UserScanHandleStartScanMsg( Context, message, threadCtx );
-                
-        } else {
-        
-            assert( FALSE ); // This thread should not receive other kinds of message.
+
+            notifications[batch.Header.BatchCount] = &message->Notification;
+            batch.ScanIds[batch.Header.BatchCount++] = message->Notification.ScanId;
         }
-        
-        
-        if (FAILED(hr)) {
 
-            fprintf(stderr,
-              "[UserScanWorker]: Failed to handle the message.\n");
+        if (batch.Header.BatchCount > 0) {
+
+            hr = UserScanCreateSections( Context, &batch, notifications );
+
+            if (FAILED(hr)) {
+
+                fprintf(stderr,
+                  "[UserScanListener]: Failed to handle the messages.\n");
+            }
         }
         
         //
@@ -1032,37 +1453,158 @@ Return Value:
         }
         
         //
-        //  After we process the message, pump a overlapped structure into completion port again.
+        //  After we process the messages, pump the overlapped structures into completion port again.
         //
         
-        hr = FilterGetMessage( Context->ConnectionPort,
-                               &message->MessageHeader,
-                               FIELD_OFFSET( SCANNER_MESSAGE, Ovlp ),
-                               &message->Ovlp );
+        for (i = 0;
+             i < messageCount;
+             i ++ ) {
 
-        if (hr == HRESULT_FROM_WIN32(ERROR_OPERATION_ABORTED)) {
-            
-            printf("FilterGetMessage aborted.\n");
-            break;
-            
-        } else if (hr != HRESULT_FROM_WIN32( ERROR_IO_PENDING )) {
+            message = messages[i];
 
-            fprintf(stderr, 
-              "[UserScanWorker]: Failed to get message from the minifilter. \n0x%x, 0x%x\n", 
-               hr, HRESULT_FROM_WIN32(GetLastError()));
-            DisplayError(hr);
-            break;
+            hr = FilterGetMessage( Context->ConnectionPort,
+                                   &message->MessageHeader,
+                                   FIELD_OFFSET( SCANNER_MESSAGE, Ovlp ),
+                                   &message->Ovlp );
+
+            if (hr == HRESULT_FROM_WIN32( ERROR_IO_PENDING )) {
+
+                hr = S_OK;
+                continue;
+            }
+
+            if (hr == HRESULT_FROM_WIN32(ERROR_OPERATION_ABORTED)) {
+                
+                printf("FilterGetMessage aborted.\n");
+                
+            } else {
+
+                fprintf(stderr, 
+                  "[UserScanListener]: Failed to get message from the minifilter. \n0x%x, 0x%x\n", 
+                   hr, HRESULT_FROM_WIN32(GetLastError()));
+                DisplayError(hr);
+            }
+
+            HeapFree(GetProcessHeap(), 0, message);
         }
+
+        messageCount = 0;
         
     }  // end of while(TRUE)
     
-    if (message) {
+    //
+    //  Free the memory, which originally allocated at UserScanInit(...)
+    //
+    
+    for (i = 0;
+         i < messageCount;
+         i ++ ) {
+
+        HeapFree(GetProcessHeap(), 0, messages[i]);
+    }
+    
+    printf("***Listening thread id %u exiting\n", threadCtx->ThreadId);
+    
+    return hr;
+}
+
+HRESULT
+UserScanWorker (
+    _Inout_   PUSER_SCAN_CONTEXT Context
+    )
+/*++
+
+Routine Description:
+
+    This routine is the scanning worker thread procedure.
+    The pseudo-code of this function is as follows,
+    
+    while(TRUE) {
+        1) Get a scan request from the scan queue.
+        2) Remember its scan id so that it can be aborted.
+        3) Process the request via calling UserScanHandleScanRequest(...)
+    }
+    
+Arguments:
+
+    Context - The user scan context.
+
+Return Value:
+    
+    S_OK if no error occurs; Otherwise, it would return appropriate HRESULT.
+    
+--*/
+{
+    HRESULT hr = S_OK;
+    
+    PSCANNER_REQUEST  request = NULL;
+    LPOVERLAPPED pOvlp = NULL;
+    
+    DWORD outSize;
+    ULONG_PTR key;
+    BOOL  success = FALSE;
+    
+    PSCANNER_THREAD_CONTEXT threadCtx = NULL;
+    
+    hr = UserScanGetThreadContextById( GetCurrentThreadId(), Context, &threadCtx );
+    if (FAILED(hr)) {
+        fprintf(stderr,
+          "[UserScanWorker]: Failed to get thread context.\n");
+        return hr;
+    }
+   
+    printf("Current thread handle %p, id:%u\n", threadCtx->Handle, threadCtx->ThreadId);
+    
+    for(;;) {
+
+        success = GetQueuedCompletionStatus( Context->ScanQueue, &outSize, &key, &pOvlp, INFINITE );
+        
+        if (!success) {
+        
+            hr = HRESULT_FROM_WIN32(GetLastError());
+            
+            if (hr == HRESULT_FROM_WIN32(ERROR_ABANDONED_WAIT_0)) {
+            
+                printf("Scan queue was closed.\n");
+                hr = S_OK;
+            }
+
+            break;
+        }
 
         //
-        //  Free the memory, which originally allocated at UserScanInit(...)
+        //  A request without a scan is the exit signal posted by 
+        //  UserScanSynchronizedCancel(...)
         //
+
+        request = (PSCANNER_REQUEST) key;
+
+        if (NULL == request) {
+
+            break;
+        }
+
+        //
+        //  Reset the abort flag since this is a new scan request and remember 
+        //  the scan context ID. This ID will allow us to match a cancel request 
+        //  with a given scan task. Requests still queued at exit are completed 
+        //  without scanning.
+        //
+
+        EnterCriticalSection(&(threadCtx->Lock));
+        threadCtx->Aborted = Context->Finalized;
+        threadCtx->ScanId = request->ScanId;
+        LeaveCriticalSection(&(threadCtx->Lock));
+
+        hr = UserScanHandleScanRequest( Context, request, threadCtx );
         
-        HeapFree(GetProcessHeap(), 0, message);
+        if (FAILED(hr)) {
+
+            fprintf(stderr,
+              "[UserScanWorker]: Failed to handle the scan request.\n");
+        }
+
+        HeapFree(GetProcessHeap(), 0, request);
     }
     
     printf("***Thread id %u exiting\n", threadCtx->ThreadId);
@@ -1162,11 +1704,11 @@ Return Value:
             //
             //  After this thread receives AvMsgAbortScanning
             //  it does
-            //    1) Find the user scan thread context
+            //    1) Find the user scan thread context which is scanning this scan id
             //    2) Set Aborted flag to be TRUE
             //
         
-            hr = UserScanGetThreadContextById(message.Notification.ScanThreadId,
+            hr = UserScanGetThreadContextByScanId(message.Notification.ScanId,
                                               Context,
                                               &threadCtx);
             if (SUCCEEDED(hr)) {
@@ -1193,7 +1735,14 @@ Return Value:
                 
             } else {
             
-                fprintf(stderr, "[UserScanListenAbortProc]: Error! UserScanGetThreadContextById failed.\n");
+                //
+                //  The scan either completed already or is still waiting in the scan 
+                //  queue. In the latter case the filter gives up on it once its abort 
+                //  wait times out.
+                //
+
+                printf("[UserScanListenAbortProc]: %lld is not being scanned\n", message.Notification.ScanId);
+                hr = S_OK;
             }
             
         } else if (AvMsgFilterUnloading == message.Notification.Message) {
@@ -66,10 +66,24 @@ typedef struct _SCANNER_THREAD_CONTEXT {
 typedef struct _USER_SCAN_CONTEXT {
 
     //
-    //  Scan thread contexts
+    //  The number of scanning worker threads. Zero selects one per 
+    //  processor. Set by the caller before UserScanInit(...).
+    //
+
+    ULONG    WorkerCount;
+
+    //
+    //  Scan thread contexts: the listening threads come first, 
+    //  followed by the scanning workers.
     //
 
     PSCANNER_THREAD_CONTEXT  ScanThreadCtxes;
+
+    //
+    //  The number of entries in ScanThreadCtxes
+    //
+
+    ULONG    ThreadCount;
     
     //
     //  The abortion thread handle
@@ -95,6 +109,13 @@ typedef struct _USER_SCAN_CONTEXT {
     
     HANDLE   Completion;
 
+    //
+    //  Completion port used as the queue of scan requests from the 
+    //  listening threads to the scanning workers.
+    //
+
+    HANDLE   ScanQueue;
+
 } USER_SCAN_CONTEXT, *PUSER_SCAN_CONTEXT;
     
 HRESULT UserScanInit (
@@ -105,5 +126,9 @@ HRESULT UserScanFinalize (
     _In_  PUSER_SCAN_CONTEXT Context
     );
 
+HRESULT UserScanPrintCacheStatistics (
+    _In_  PUSER_SCAN_CONTEXT Context
+    );
+
 #endif
 
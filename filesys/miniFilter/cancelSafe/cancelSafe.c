@@ -46,6 +46,7 @@ Environment:
 #define QUEUE_CONTEXT_TAG                 'QqsC'
 #define CSQ_REG_TAG                       'RqsC'
 #define CSQ_STRING_TAG                    'SqsC'
+#define IO_QUEUE_TAG                      'AqsC'
 
 //
 // Registry value names and default values
@@ -56,8 +57,24 @@ Environment:
 #define CSQ_KEY_NAME_DELAY                L"OperatingDelay"
 #define CSQ_KEY_NAME_PATH                 L"OperatingPath"
 #define CSQ_KEY_NAME_DEBUG_LEVEL          L"DebugLevel"
+#define CSQ_KEY_NAME_QUEUE_COUNT          L"QueueCount"
+#define CSQ_KEY_NAME_WORKER_COUNT         L"WorkerCount"
+#define CSQ_KEY_NAME_BATCH_SIZE           L"CompletionBatchSize"
 #define CSQ_MAX_PATH_LENGTH               256
 
+//
+//  Queue and worker configuration. The defaults give the classic layout of
+//  one queue drained by one worker. A QueueCount or WorkerCount of 0 means
+//  one per active processor.
+//
+
+#define CSQ_DEFAULT_QUEUE_COUNT           1
+#define CSQ_DEFAULT_WORKER_COUNT          1
+#define CSQ_DEFAULT_BATCH_SIZE            1
+#define CSQ_MAX_QUEUE_COUNT               64
+#define CSQ_MAX_WORKER_COUNT              64
+#define CSQ_MAX_BATCH_SIZE                64
+
 
 //
 //  Prototypes
@@ -73,6 +90,31 @@ typedef struct _QUEUE_CONTEXT {
 
 } QUEUE_CONTEXT, *PQUEUE_CONTEXT;
 
+typedef struct _INSTANCE_CONTEXT *PINSTANCE_CONTEXT;
+
+//
+//  I/O queue data structure. Every instance has one or more of these, and
+//  reads are inserted into the queue of the processor they are issued on.
+//
+
+typedef struct _IO_QUEUE {
+
+    //
+    //  Cancel safe queue members
+    //
+
+    FLT_CALLBACK_DATA_QUEUE Cbdq;
+    LIST_ENTRY QueueHead;
+    FAST_MUTEX Lock;
+
+    //
+    //  Instance context this queue belongs to.
+    //
+
+    PINSTANCE_CONTEXT InstanceContext;
+
+} IO_QUEUE, *PIO_QUEUE;
+
 //
 //  Instance context data structure
 //
@@ -86,26 +128,36 @@ typedef struct _INSTANCE_CONTEXT {
     PFLT_INSTANCE Instance;
 
     //
-    //  Cancel safe queue members
+    //  Cancel safe queues
     //
 
-    FLT_CALLBACK_DATA_QUEUE Cbdq;
-    LIST_ENTRY QueueHead;
-    FAST_MUTEX Lock;
+    PIO_QUEUE Queues;
+    ULONG QueueCount;
 
     //
-    //  Flag to control the life/death of the work item thread
+    //  Number of I/Os in all the queues of this instance.
     //
 
-    volatile LONG WorkerThreadFlag;
+    volatile LONG PendingCount;
 
     //
-    //  Notify the worker thread that the instance is being torndown
+    //  Worker pool. ActiveWorkers counts the work items that are queued or
+    //  running, and never exceeds MaxWorkers. NextHomeQueue spreads the
+    //  workers over the queues; a worker steals from the other queues when
+    //  its own is empty.
+    //
+
+    ULONG MaxWorkers;
+    volatile LONG ActiveWorkers;
+    volatile LONG NextHomeQueue;
+
+    //
+    //  Notify the workers that the instance is being torndown
     //
 
     KEVENT TeardownEvent;
 
-} INSTANCE_CONTEXT, *PINSTANCE_CONTEXT;
+} INSTANCE_CONTEXT;
 
 
 typedef struct _CSQ_GLOBAL_DATA {
@@ -121,6 +173,16 @@ typedef struct _CSQ_GLOBAL_DATA {
     PWSTR PathBuffer;
 
     LONGLONG TimeDelay;
+
+    //
+    //  Queue and worker configuration
+    //
+
+    ULONG QueueCount;
+
+    ULONG WorkerCount;
+
+    ULONG CompletionBatchSize;
     
 } CSQ_GLOBAL_DATA;
 
@@ -193,8 +255,8 @@ SetConfiguration (
 VOID
 _IRQL_requires_max_(APC_LEVEL)
 _IRQL_raises_(APC_LEVEL)
-_Requires_lock_not_held_((CONTAINING_RECORD( DataQueue, INSTANCE_CONTEXT, Cbdq ))->Lock)
-_Acquires_lock_((CONTAINING_RECORD( DataQueue, INSTANCE_CONTEXT, Cbdq ))->Lock)
+_Requires_lock_not_held_((CONTAINING_RECORD( DataQueue, IO_QUEUE, Cbdq ))->Lock)
+_Acquires_lock_((CONTAINING_RECORD( DataQueue, IO_QUEUE, Cbdq ))->Lock)
 CsqAcquire(
     _In_ PFLT_CALLBACK_DATA_QUEUE DataQueue,
     _Out_ PKIRQL Irql
@@ -204,8 +266,8 @@ VOID
 _IRQL_requires_max_(APC_LEVEL)
 _IRQL_requires_min_(APC_LEVEL)
 _IRQL_raises_(PASSIVE_LEVEL)
-_Requires_lock_held_((CONTAINING_RECORD( DataQueue, INSTANCE_CONTEXT, Cbdq ))->Lock)
-_Releases_lock_((CONTAINING_RECORD( DataQueue, INSTANCE_CONTEXT, Cbdq ))->Lock)
+_Requires_lock_held_((CONTAINING_RECORD( DataQueue, IO_QUEUE, Cbdq ))->Lock)
+_Releases_lock_((CONTAINING_RECORD( DataQueue, IO_QUEUE, Cbdq ))->Lock)
 CsqRelease(
     _In_ PFLT_CALLBACK_DATA_QUEUE DataQueue,
     _In_ KIRQL Irql
@@ -263,6 +325,28 @@ PreReadEmptyQueueAndComplete(
     _In_ PINSTANCE_CONTEXT InstanceContext
     );
 
+NTSTATUS
+PreReadStartWorker(
+    _In_ PINSTANCE_CONTEXT InstanceContext,
+    _In_ LONG PendingCount
+    );
+
+BOOLEAN
+PreReadStopWorker(
+    _In_ PINSTANCE_CONTEXT InstanceContext
+    );
+
+PFLT_CALLBACK_DATA
+PreReadRemoveNextIo(
+    _In_ PINSTANCE_CONTEXT InstanceContext,
+    _In_ ULONG HomeQueue
+    );
+
+VOID
+PreReadCompleteIo(
+    _Inout_ PFLT_CALLBACK_DATA Data
+    );
+
 //
 //  Assign text sections for each routine.
 //
@@ -389,6 +473,12 @@ Return Value:
 
     RtlInitUnicodeString( &Globals.MappingPath, CSQ_DEFAULT_MAPPING_PATH );
 
+    Globals.QueueCount = CSQ_DEFAULT_QUEUE_COUNT;
+
+    Globals.WorkerCount = CSQ_DEFAULT_WORKER_COUNT;
+
+    Globals.CompletionBatchSize = CSQ_DEFAULT_BATCH_SIZE;
+
 
     //
     //  Modify the configuration based on values in the registry
@@ -465,8 +555,8 @@ SetConfiguration (
 
 Routine Description:
 
-    This routine tries to configure the debuglevel, mapping path and
-    queue delay based on values in the registry.
+    This routine tries to configure the debuglevel, mapping path, queue
+    delay and the queue and worker layout based on values in the registry.
 
 Arguments:
 
@@ -556,6 +646,78 @@ Return Value:
         
     }
   
+    //
+    //  Query the number of queues per instance
+    //
+
+    RtlInitUnicodeString( &ValueName, CSQ_KEY_NAME_QUEUE_COUNT );
+
+    Status = ZwQueryValueKey( DriverRegKey,
+                              &ValueName,
+                              KeyValuePartialInformation,
+                              Value,
+                              ValueLength,
+                              &ResultLength );
+
+    if (NT_SUCCESS( Status )) {
+
+        if (Value->Type != REG_DWORD) {
+
+            Status = STATUS_INVALID_PARAMETER;
+            goto SetConfigurationCleanup;
+        }
+
+        Globals.QueueCount = min( *(PULONG)(Value->Data), CSQ_MAX_QUEUE_COUNT );
+    }
+
+    //
+    //  Query the maximum number of workers per instance
+    //
+
+    RtlInitUnicodeString( &ValueName, CSQ_KEY_NAME_WORKER_COUNT );
+
+    Status = ZwQueryValueKey( DriverRegKey,
+                              &ValueName,
+                              KeyValuePartialInformation,
+                              Value,
+                              ValueLength,
+                              &ResultLength );
+
+    if (NT_SUCCESS( Status )) {
+
+        if (Value->Type != REG_DWORD) {
+
+            Status = STATUS_INVALID_PARAMETER;
+            goto SetConfigurationCleanup;
+        }
+
+        Globals.WorkerCount = min( *(PULONG)(Value->Data), CSQ_MAX_WORKER_COUNT );
+    }
+
+    //
+    //  Query the completion batch size
+    //
+
+    RtlInitUnicodeString( &ValueName, CSQ_KEY_NAME_BATCH_SIZE );
+
+    Status = ZwQueryValueKey( DriverRegKey,
+                              &ValueName,
+                              KeyValuePartialInformation,
+                              Value,
+                              ValueLength,
+                              &ResultLength );
+
+    if (NT_SUCCESS( Status )) {
+
+        if (Value->Type != REG_DWORD || *(PULONG)(Value->Data) == 0) {
+
+            Status = STATUS_INVALID_PARAMETER;
+            goto SetConfigurationCleanup;
+        }
+
+        Globals.CompletionBatchSize = min( *(PULONG)(Value->Data), CSQ_MAX_BATCH_SIZE );
+    }
+
     //
     // Query the mapping path
     //
@@ -745,13 +907,23 @@ Return Value:
 
 --*/
 {
-    UNREFERENCED_PARAMETER( Context );
-    UNREFERENCED_PARAMETER( ContextType );
+    PINSTANCE_CONTEXT InstCtx;
 
     PAGED_CODE();
 
     DebugTrace( CSQ_TRACE_CONTEXT_CALLBACK,
                 ("[Csq]: CancelSafe!ContextCleanup\n") );
+
+    if (ContextType == FLT_INSTANCE_CONTEXT) {
+
+        InstCtx = (PINSTANCE_CONTEXT) Context;
+
+        if (InstCtx->Queues != NULL) {
+
+            ExFreePoolWithTag( InstCtx->Queues, IO_QUEUE_TAG );
+            InstCtx->Queues = NULL;
+        }
+    }
 }
 
 //
@@ -794,6 +966,8 @@ Return Value:
 {
     PINSTANCE_CONTEXT InstCtx = NULL;
     NTSTATUS Status = STATUS_SUCCESS;
+    ULONG ProcessorCount;
+    ULONG Index;
 
     UNREFERENCED_PARAMETER( Flags );
     UNREFERENCED_PARAMETER( VolumeDeviceType );
@@ -825,19 +999,38 @@ Return Value:
         goto InstanceSetupCleanup;
     }
 
-    Status = FltCbdqInitialize( FltObjects->Instance,
-                                &InstCtx->Cbdq,
-                                CsqInsertIo,
-                                CsqRemoveIo,
-                                CsqPeekNextIo,
-                                CsqAcquire,
-                                CsqRelease,
-                                CsqCompleteCanceledIo );
+    RtlZeroMemory( InstCtx, sizeof( INSTANCE_CONTEXT ) );
 
-    if (!NT_SUCCESS( Status )) {
+    //
+    //  Size the queues and the worker pool.
+    //
+
+    ProcessorCount = KeQueryActiveProcessorCountEx( ALL_PROCESSOR_GROUPS );
+
+    InstCtx->QueueCount = Globals.QueueCount;
+
+    if (InstCtx->QueueCount == 0) {
+
+        InstCtx->QueueCount = min( ProcessorCount, CSQ_MAX_QUEUE_COUNT );
+    }
+
+    InstCtx->MaxWorkers = Globals.WorkerCount;
+
+    if (InstCtx->MaxWorkers == 0) {
+
+        InstCtx->MaxWorkers = min( ProcessorCount, CSQ_MAX_WORKER_COUNT );
+    }
+
+    InstCtx->Queues = ExAllocatePoolWithTag( NonPagedPool,
+                                             InstCtx->QueueCount * sizeof( IO_QUEUE ),
+                                             IO_QUEUE_TAG );
+
+    if (InstCtx->Queues == NULL) {
+
+        Status = STATUS_INSUFFICIENT_RESOURCES;
 
         DebugTrace( CSQ_TRACE_INSTANCE_CALLBACK | CSQ_TRACE_ERROR,
-                    ("[Csq]: Failed to initialize callback data queue (Volume = %p, Instance = %p, Status = 0x%x)\n",
+                    ("[Csq]: Failed to allocate the queues (Volume = %p, Instance = %p, Status = 0x%x)\n",
                     FltObjects->Volume,
                     FltObjects->Instance,
                     Status) );
@@ -845,13 +1038,38 @@ Return Value:
         goto InstanceSetupCleanup;
     }
 
-    //
-    //  Initialize the internal queue head and lock of the cancel safe queue.
-    //
+    for (Index = 0; Index < InstCtx->QueueCount; Index++) {
 
-    InitializeListHead( &InstCtx->QueueHead );
+        Status = FltCbdqInitialize( FltObjects->Instance,
+                                    &InstCtx->Queues[Index].Cbdq,
+                                    CsqInsertIo,
+                                    CsqRemoveIo,
+                                    CsqPeekNextIo,
+                                    CsqAcquire,
+                                    CsqRelease,
+                                    CsqCompleteCanceledIo );
 
-    ExInitializeFastMutex( &InstCtx->Lock );
+        if (!NT_SUCCESS( Status )) {
+
+            DebugTrace( CSQ_TRACE_INSTANCE_CALLBACK | CSQ_TRACE_ERROR,
+                        ("[Csq]: Failed to initialize callback data queue (Volume = %p, Instance = %p, Status = 0x%x)\n",
+                        FltObjects->Volume,
+                        FltObjects->Instance,
+                        Status) );
+
+            goto InstanceSetupCleanup;
+        }
+
+        //
+        //  Initialize the internal queue head and lock of the cancel safe queue.
+        //
+
+        InitializeListHead( &InstCtx->Queues[Index].QueueHead );
+
+        ExInitializeFastMutex( &InstCtx->Queues[Index].Lock );
+
+        InstCtx->Queues[Index].InstanceContext = InstCtx;
+    }
 
     //
     //  Initialize other members of the instance context.
@@ -859,8 +1077,6 @@ Return Value:
 
     InstCtx->Instance = FltObjects->Instance;
 
-    InstCtx->WorkerThreadFlag = 0;
-
     KeInitializeEvent( &InstCtx->TeardownEvent, NotificationEvent, FALSE );
 
     //
@@ -959,6 +1175,7 @@ Return Value:
 {
     PINSTANCE_CONTEXT InstCtx = 0;
     NTSTATUS Status;
+    ULONG Index;
 
     UNREFERENCED_PARAMETER( FltObjects );
     UNREFERENCED_PARAMETER( Flags );
@@ -982,10 +1199,13 @@ Return Value:
     }
 
     //
-    //  Disable the insert to the cancel safe queue.
+    //  Disable the insert to the cancel safe queues.
     //
 
-    FltCbdqDisable( &InstCtx->Cbdq );
+    for (Index = 0; Index < InstCtx->QueueCount; Index++) {
+
+        FltCbdqDisable( &InstCtx->Queues[Index].Cbdq );
+    }
 
     //
     //  Remove all callback data from the queue and complete them.
@@ -994,7 +1214,7 @@ Return Value:
     PreReadEmptyQueueAndComplete( InstCtx );
 
     //
-    //  Signal the worker thread if it is pended.
+    //  Signal the workers if they are pended.
     //
 
     KeSetEvent( &InstCtx->TeardownEvent, 0, FALSE );
@@ -1048,8 +1268,8 @@ Return Value:
 VOID
 _IRQL_requires_max_(APC_LEVEL)
 _IRQL_raises_(APC_LEVEL)
-_Requires_lock_not_held_((CONTAINING_RECORD( DataQueue, INSTANCE_CONTEXT, Cbdq ))->Lock)
-_Acquires_lock_((CONTAINING_RECORD( DataQueue, INSTANCE_CONTEXT, Cbdq ))->Lock)
+_Requires_lock_not_held_((CONTAINING_RECORD( DataQueue, IO_QUEUE, Cbdq ))->Lock)
+_Acquires_lock_((CONTAINING_RECORD( DataQueue, IO_QUEUE, Cbdq ))->Lock)
 CsqAcquire(
     _In_ PFLT_CALLBACK_DATA_QUEUE DataQueue,
     _Out_ PKIRQL Irql
@@ -1073,22 +1293,22 @@ Return Value:
 
 --*/
 {
-    PINSTANCE_CONTEXT InstCtx;
+    PIO_QUEUE Queue;
 
     DebugTrace( CSQ_TRACE_CBDQ_CALLBACK,
                 ("[Csq]: CancelSafe!CsqAcquire\n") );
 
     //
-    //  Get a pointer to the instance context.
+    //  Get a pointer to the queue.
     //
 
-    InstCtx = CONTAINING_RECORD( DataQueue, INSTANCE_CONTEXT, Cbdq );
+    Queue = CONTAINING_RECORD( DataQueue, IO_QUEUE, Cbdq );
 
     //
     //  Acquire the lock.
     //
 
-    ExAcquireFastMutex( &InstCtx->Lock );
+    ExAcquireFastMutex( &Queue->Lock );
 
     *Irql = 0;
 }
@@ -1098,8 +1318,8 @@ VOID
 _IRQL_requires_max_(APC_LEVEL)
 _IRQL_requires_min_(APC_LEVEL)
 _IRQL_raises_(PASSIVE_LEVEL)
-_Requires_lock_held_((CONTAINING_RECORD( DataQueue, INSTANCE_CONTEXT, Cbdq ))->Lock)
-_Releases_lock_((CONTAINING_RECORD( DataQueue, INSTANCE_CONTEXT, Cbdq ))->Lock)
+_Requires_lock_held_((CONTAINING_RECORD( DataQueue, IO_QUEUE, Cbdq ))->Lock)
+_Releases_lock_((CONTAINING_RECORD( DataQueue, IO_QUEUE, Cbdq ))->Lock)
 CsqRelease(
     _In_ PFLT_CALLBACK_DATA_QUEUE DataQueue,
     _In_ KIRQL Irql
@@ -1123,7 +1343,7 @@ Return Value:
 
 --*/
 {
-    PINSTANCE_CONTEXT InstCtx;
+    PIO_QUEUE Queue;
 
     UNREFERENCED_PARAMETER( Irql );
 
@@ -1131,16 +1351,16 @@ Return Value:
                 ("[Csq]: CancelSafe!CsqRelease\n") );
 
     //
-    //  Get a pointer to the instance context.
+    //  Get a pointer to the queue.
     //
 
-    InstCtx = CONTAINING_RECORD( DataQueue, INSTANCE_CONTEXT, Cbdq );
+    Queue = CONTAINING_RECORD( DataQueue, IO_QUEUE, Cbdq );
 
     //
     //  Release the lock.
     //
 
-    ExReleaseFastMutex( &InstCtx->Lock );
+    ExReleaseFastMutex( &Queue->Lock );
 }
 
 
@@ -1173,10 +1393,10 @@ Return Value:
 
 --*/
 {
+    PIO_QUEUE Queue;
     PINSTANCE_CONTEXT InstCtx;
-    PFLT_GENERIC_WORKITEM WorkItem = NULL;
-    NTSTATUS Status = STATUS_SUCCESS;
-    BOOLEAN WasQueueEmpty;
+    NTSTATUS Status;
+    LONG PendingCount;
 
     UNREFERENCED_PARAMETER( Context );
 
@@ -1184,77 +1404,37 @@ Return Value:
                 ("[Csq]: CancelSafe!CsqInsertIo\n") );
 
     //
-    //  Get a pointer to the instance context.
-    //
-
-    InstCtx = CONTAINING_RECORD( DataQueue, INSTANCE_CONTEXT, Cbdq );
-
-    //
-    //  Save the queue state before inserting to it.
+    //  Get a pointer to the queue and its instance context.
     //
 
-    WasQueueEmpty = IsListEmpty( &InstCtx->QueueHead );
+    Queue = CONTAINING_RECORD( DataQueue, IO_QUEUE, Cbdq );
+    InstCtx = Queue->InstanceContext;
 
     //
     //  Insert the callback data entry into the queue.
     //
 
-    InsertTailList( &InstCtx->QueueHead,
+    InsertTailList( &Queue->QueueHead,
                     &Data->QueueLinks );
 
+    PendingCount = InterlockedIncrement( &InstCtx->PendingCount );
+
     //
-    //  Queue a work item if no worker thread present.
+    //  Make sure there is a worker to process it.
     //
 
-    if (WasQueueEmpty &&
-        InterlockedIncrement( &InstCtx->WorkerThreadFlag ) == 1) {
-
-        WorkItem = FltAllocateGenericWorkItem();
-
-        if (WorkItem) {
-
-            Status = FltQueueGenericWorkItem( WorkItem,
-                                              InstCtx->Instance,
-                                              PreReadWorkItemRoutine,
-                                              DelayedWorkQueue,
-                                              InstCtx->Instance );
-
-            if (!NT_SUCCESS( Status )) {
-
-                DebugTrace( CSQ_TRACE_CBDQ_CALLBACK | CSQ_TRACE_ERROR,
-                            ("[Csq]: Failed to queue the work item (Status = 0x%x)\n",
-                            Status) );
-
-                FltFreeGenericWorkItem( WorkItem );
-            }
-
-        } else {
-
-            Status = STATUS_INSUFFICIENT_RESOURCES;
-        }
-
-        if (!NT_SUCCESS( Status )) {
-
-            //
-            //  If we failed to queue a workitem we need to
-            //  decrement the worker thread flag. If we did
-            //  not decrement it future queue insertions would
-            //  not trigger a workitem and requests added to
-            //  the queue would be orphaned. We can safely
-            //  decrement the flag here because we are
-            //  guaranteed that no worker routine is currently
-            //  running and that the queue is currently locked.
-            //
+    Status = PreReadStartWorker( InstCtx, PendingCount );
 
-            InterlockedDecrement( &InstCtx->WorkerThreadFlag );
-            NT_ASSERT( InstCtx->WorkerThreadFlag == 0 );
+    if (!NT_SUCCESS( Status )) {
 
-            //
-            //  Remove the callback data that was inserted into the queue.
-            //
+        //
+        //  No worker is left that could process the callback data, so
+        //  remove it from the queue again. We can safely do this here
+        //  because the queue is currently locked.
+        //
 
-            RemoveTailList( &InstCtx->QueueHead );
-        }
+        RemoveTailList( &Queue->QueueHead );
+        InterlockedDecrement( &InstCtx->PendingCount );
     }
 
     return Status;
@@ -1285,16 +1465,20 @@ Return Value:
 
 --*/
 {
-    UNREFERENCED_PARAMETER( DataQueue );
+    PIO_QUEUE Queue;
 
     DebugTrace( CSQ_TRACE_CBDQ_CALLBACK,
                 ("[Csq]: CancelSafe!CsqRemoveIo\n") );
 
+    Queue = CONTAINING_RECORD( DataQueue, IO_QUEUE, Cbdq );
+
     //
     //  Remove the callback data entry from the queue.
     //
 
     RemoveEntryList( &Data->QueueLinks );
+
+    InterlockedDecrement( &Queue->InstanceContext->PendingCount );
 }
 
 
@@ -1326,7 +1510,7 @@ Return Value:
 
 --*/
 {
-    PINSTANCE_CONTEXT InstCtx;
+    PIO_QUEUE Queue;
     PLIST_ENTRY NextEntry;
     PFLT_CALLBACK_DATA NextData;
 
@@ -1336,10 +1520,10 @@ Return Value:
                 ("[Csq]: CancelSafe!CsqPeekNextIo\n") );
 
     //
-    //  Get a pointer to the instance context.
+    //  Get a pointer to the queue.
     //
 
-    InstCtx = CONTAINING_RECORD( DataQueue, INSTANCE_CONTEXT, Cbdq );
+    Queue = CONTAINING_RECORD( DataQueue, IO_QUEUE, Cbdq );
 
     //
     //  If the supplied callback "Data" is NULL, the "NextIo" is the first entry
@@ -1348,7 +1532,7 @@ Return Value:
 
     if (Data == NULL) {
 
-        NextEntry = InstCtx->QueueHead.Flink;
+        NextEntry = Queue->QueueHead.Flink;
 
     } else {
 
@@ -1359,7 +1543,7 @@ Return Value:
     //  Return NULL if we hit the end of the queue or the queue is empty.
     //
 
-    if (NextEntry == &InstCtx->QueueHead) {
+    if (NextEntry == &Queue->QueueHead) {
 
         return NULL;
     }
@@ -1455,6 +1639,7 @@ Return Value:
 
     PINSTANCE_CONTEXT InstCtx = NULL;
     PQUEUE_CONTEXT QueueCtx = NULL;
+    PIO_QUEUE Queue;
     PFLT_FILE_NAME_INFORMATION NameInfo = NULL;
     NTSTATUS CbStatus = FLT_PREOP_SUCCESS_NO_CALLBACK;
     NTSTATUS Status;
@@ -1567,10 +1752,13 @@ Return Value:
     Data->QueueContext[1] = NULL;
 
     //
-    //  Insert the callback data into the cancel safe queue
+    //  Insert the callback data into the cancel safe queue of the current
+    //  processor.
     //
 
-    Status = FltCbdqInsertIo( &InstCtx->Cbdq,
+    Queue = &InstCtx->Queues[KeGetCurrentProcessorNumberEx( NULL ) % InstCtx->QueueCount];
+
+    Status = FltCbdqInsertIo( &Queue->Cbdq,
                               Data,
                               &QueueCtx->CbdqIoContext,
                               0 );
@@ -1580,7 +1768,7 @@ Return Value:
         //
         //  In general, we can create a worker thread here as long as we can
         //  correctly handle the insert/remove race conditions b/w multi threads.
-        //  In this sample, the worker thread creation is done in CsqInsertIo.
+        //  In this sample, the worker creation is done in CsqInsertIo.
         //  This is a simpler solution because CsqInsertIo is atomic with 
         //  respect to other CsqXxxIo callback routines.
         //
@@ -1630,9 +1818,10 @@ PreReadWorkItemRoutine(
 Routine Description:
 
     This WorkItem routine is called in the system thread context to process
-    all the pended I/O in this mini filter's cancel safe queue. For each I/O
-    in the queue, it completes the I/O after pending the operation for a
-    period of time. The thread exits when the queue is empty.
+    the pended I/O in this mini filter's cancel safe queues. Each worker of
+    the pool has a home queue, and takes I/O from the other queues when its
+    own is empty. After pending for a period of time, it completes up to
+    CompletionBatchSize I/Os. The thread exits when all the queues are empty.
 
 Arguments:
 
@@ -1651,11 +1840,10 @@ Return Value:
     PINSTANCE_CONTEXT InstCtx = NULL;
     PFLT_CALLBACK_DATA Data;
     PFLT_INSTANCE Instance = (PFLT_INSTANCE)Context;
-    PQUEUE_CONTEXT QueueCtx;
     NTSTATUS Status;
-    FLT_PREOP_CALLBACK_STATUS callbackStatus;
+    ULONG HomeQueue;
+    ULONG Completed;
 
-    UNREFERENCED_PARAMETER( WorkItem );
     UNREFERENCED_PARAMETER( Filter );
 
     DebugTrace( CSQ_TRACE_PRE_READ,
@@ -1674,125 +1862,334 @@ Return Value:
         return;
     }
 
+    HomeQueue = (ULONG) InterlockedIncrement( &InstCtx->NextHomeQueue ) % InstCtx->QueueCount;
+
     //
-    //  Process all the pended I/O in the cancel safe queue
+    //  Process the pended I/O in the cancel safe queues
     //
 
     for (;;) {
 
-        callbackStatus = FLT_PREOP_SUCCESS_NO_CALLBACK;
-
         PreReadPendIo( InstCtx );
 
         //
-        //  WorkerThreadFlag >= 1;
-        //  Here we reduce it to 1.
+        //  Complete a batch of I/O.
         //
 
-        InterlockedExchange( &InstCtx->WorkerThreadFlag, 1 );
+        for (Completed = 0; Completed < Globals.CompletionBatchSize; Completed++) {
 
-        //
-        //  Remove an I/O from the cancel safe queue.
-        //
-
-        Data = FltCbdqRemoveNextIo( &InstCtx->Cbdq,
-                                    NULL);
+            Data = PreReadRemoveNextIo( InstCtx, HomeQueue );
 
-        if (Data) {
+            if (Data == NULL) {
 
-            QueueCtx = (PQUEUE_CONTEXT) Data->QueueContext[0];
+                break;
+            }
 
             PreReadProcessIo( Data );
 
-            //
-            //  Check to see if we need to lock the user buffer.
-            //
-            //  If the FLTFL_CALLBACK_DATA_SYSTEM_BUFFER flag is set we don't 
-            //  have to lock the buffer because its already a system buffer.
-            //
-            //  If the MdlAddress is NULL and the buffer is a user buffer, 
-            //  then we have to construct one in order to look at the buffer.
-            //
-            //  If the length of the buffer is zero there is nothing to read,
-            //  so we cannot construct a MDL.
-            //
+            PreReadCompleteIo( Data );
+        }
 
-            if (!FlagOn(Data->Flags, FLTFL_CALLBACK_DATA_SYSTEM_BUFFER) && 
-                Data->Iopb->Parameters.Read.MdlAddress == NULL &&
-                Data->Iopb->Parameters.Read.Length > 0) {
-
-                Status = FltLockUserBuffer( Data );
-
-                if (!NT_SUCCESS( Status )) {
-                    
-                    //
-                    //  If could not lock the user buffer we cannot
-                    //  allow the IO to go below us. Because we are 
-                    //  in a different VA space and the buffer is a
-                    //  user mode address, we will either fault or 
-                    //  corrpt data
-                    //
-                   
-                    DebugTrace( CSQ_TRACE_PRE_READ | CSQ_TRACE_ERROR,
-                                ("[Csq]: Failed to lock user buffer (Status = 0x%x)\n",
-                                Status) );
-
-                    callbackStatus = FLT_PREOP_COMPLETE;
-                    Data->IoStatus.Status = Status;
-                }
-            }
+        if (Completed == 0 &&
+            PreReadStopWorker( InstCtx )) {
+
+            break;
+        }
+    }
+
+    //
+    //  Clean up
+    //
+
+    FltReleaseContext(InstCtx);
+
+    FltFreeGenericWorkItem(WorkItem);
+}
+
+
+NTSTATUS
+PreReadStartWorker(
+    _In_ PINSTANCE_CONTEXT InstanceContext,
+    _In_ LONG PendingCount
+    )
+/*++
+
+Routine Description:
+
+    This routine is called after an I/O was inserted into one of the
+    queues. It adds a worker to the pool unless the pool is already at its
+    limit or there are at least as many workers as pended I/Os.
+
+Arguments:
+
+    InstanceContext - Supplies a pointer to the instance context.
+
+    PendingCount - Number of I/Os pended in the queues of the instance,
+                   including the one just inserted.
+
+Return Value:
+
+    STATUS_SUCCESS if a worker will process the I/O. Otherwise a valid
+    NTSTATUS code is returned.
+
+--*/
+{
+    PFLT_GENERIC_WORKITEM WorkItem;
+    NTSTATUS Status;
+    LONG ActiveWorkers;
+
+    //
+    //  Reserve a slot in the pool.
+    //
+
+    for (;;) {
+
+        ActiveWorkers = InstanceContext->ActiveWorkers;
+
+        if (ActiveWorkers >= (LONG) InstanceContext->MaxWorkers ||
+            ActiveWorkers >= PendingCount) {
 
             //
-            //  Complete the I/O
+            //  The active workers will pick the I/O up. A worker that is about
+            //  to exit checks PendingCount after leaving the pool, so it cannot
+            //  miss this I/O.
             //
 
-            FltCompletePendedPreOperation( Data,
-                                           callbackStatus,
-                                           NULL );
+            return STATUS_SUCCESS;
+        }
+
+        if (InterlockedCompareExchange( &InstanceContext->ActiveWorkers,
+                                        ActiveWorkers + 1,
+                                        ActiveWorkers ) == ActiveWorkers) {
+
+            break;
+        }
+    }
+
+    WorkItem = FltAllocateGenericWorkItem();
+
+    if (WorkItem) {
+
+        Status = FltQueueGenericWorkItem( WorkItem,
+                                          InstanceContext->Instance,
+                                          PreReadWorkItemRoutine,
+                                          DelayedWorkQueue,
+                                          InstanceContext->Instance );
+
+        if (!NT_SUCCESS( Status )) {
+
+            DebugTrace( CSQ_TRACE_CBDQ_CALLBACK | CSQ_TRACE_ERROR,
+                        ("[Csq]: Failed to queue the work item (Status = 0x%x)\n",
+                        Status) );
+
+            FltFreeGenericWorkItem( WorkItem );
+        }
+
+    } else {
+
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    if (!NT_SUCCESS( Status )) {
+
+        //
+        //  Give the slot back. If other workers were active when the slot was
+        //  reserved they will process the I/O, so only fail the insert if
+        //  this was going to be the only worker.
+        //
+
+        InterlockedDecrement( &InstanceContext->ActiveWorkers );
+
+        if (ActiveWorkers > 0) {
+
+            Status = STATUS_SUCCESS;
+        }
+    }
+
+    return Status;
+}
+
+
+BOOLEAN
+PreReadStopWorker(
+    _In_ PINSTANCE_CONTEXT InstanceContext
+    )
+/*++
+
+Routine Description:
+
+    This routine is called by a worker that found all the queues empty. It
+    removes the worker from the pool.
+
+    At this moment it is possible that a new I/O is being inserted into a
+    queue by CsqInsertIo, which saw the pool at its limit and therefore did
+    not add a worker. Because CsqInsertIo counts the I/O in PendingCount
+    before looking at the pool, and this routine leaves the pool before
+    looking at PendingCount, at least one side sees the other:
+
+    (1) If the worker sees the I/O, it takes its slot back and continues.
+    (2) Otherwise CsqInsertIo sees the free slot and adds a worker.
+
+Arguments:
+
+    InstanceContext - Supplies a pointer to the instance context.
+
+Return Value:
+
+    TRUE if the worker should exit, FALSE if it should continue.
+
+--*/
+{
+    LONG ActiveWorkers;
+
+    InterlockedDecrement( &InstanceContext->ActiveWorkers );
+
+    while (InstanceContext->PendingCount > 0) {
+
+        ActiveWorkers = InstanceContext->ActiveWorkers;
+
+        if (ActiveWorkers >= (LONG) InstanceContext->MaxWorkers) {
 
             //
-            //  Free the extra storage that was allocated for this I/O.
+            //  The pool was refilled, the other workers will process the I/O.
             //
 
-            ExFreeToNPagedLookasideList( &Globals.QueueContextLookaside,
-                                         QueueCtx );
+            break;
+        }
 
-        } else {
+        if (InterlockedCompareExchange( &InstanceContext->ActiveWorkers,
+                                        ActiveWorkers + 1,
+                                        ActiveWorkers ) == ActiveWorkers) {
 
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+PFLT_CALLBACK_DATA
+PreReadRemoveNextIo(
+    _In_ PINSTANCE_CONTEXT InstanceContext,
+    _In_ ULONG HomeQueue
+    )
+/*++
+
+Routine Description:
+
+    This routine removes the next I/O from the home queue of a worker. If the
+    home queue is empty, it steals the next I/O from the other queues.
+
+Arguments:
+
+    InstanceContext - Supplies a pointer to the instance context.
+
+    HomeQueue - Supplies the index of the home queue of the worker.
+
+Return Value:
+
+    The removed callback data, or NULL if all the queues are empty.
+
+--*/
+{
+    PFLT_CALLBACK_DATA Data;
+    ULONG Index;
+
+    for (Index = 0; Index < InstanceContext->QueueCount; Index++) {
+
+        Data = FltCbdqRemoveNextIo( &InstanceContext->Queues[(HomeQueue + Index) % InstanceContext->QueueCount].Cbdq,
+                                    NULL );
+
+        if (Data) {
+
+            return Data;
+        }
+    }
+
+    return NULL;
+}
+
+
+VOID
+PreReadCompleteIo(
+    _Inout_ PFLT_CALLBACK_DATA Data
+    )
+/*++
+
+Routine Description:
+
+    This routine completes an I/O that was removed from the queue and frees
+    its queue context.
+
+Arguments:
+
+    Data - Supplies the callback data that was removed from the queue.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PQUEUE_CONTEXT QueueCtx;
+    NTSTATUS Status;
+    FLT_PREOP_CALLBACK_STATUS callbackStatus = FLT_PREOP_SUCCESS_NO_CALLBACK;
+
+    QueueCtx = (PQUEUE_CONTEXT) Data->QueueContext[0];
+
+    //
+    //  Check to see if we need to lock the user buffer.
+    //
+    //  If the FLTFL_CALLBACK_DATA_SYSTEM_BUFFER flag is set we don't 
+    //  have to lock the buffer because its already a system buffer.
+    //
+    //  If the MdlAddress is NULL and the buffer is a user buffer, 
+    //  then we have to construct one in order to look at the buffer.
+    //
+    //  If the length of the buffer is zero there is nothing to read,
+    //  so we cannot construct a MDL.
+    //
+
+    if (!FlagOn(Data->Flags, FLTFL_CALLBACK_DATA_SYSTEM_BUFFER) && 
+        Data->Iopb->Parameters.Read.MdlAddress == NULL &&
+        Data->Iopb->Parameters.Read.Length > 0) {
+
+        Status = FltLockUserBuffer( Data );
+
+        if (!NT_SUCCESS( Status )) {
+            
             //
-            //  At this moment it is possible that a new IO is being inserted
-            //  into the queue in the CsqInsertIo routine. Now that the queue is
-            //  empty, CsqInsertIo needs to make a decision on whether to create
-            //  a new worker thread. The decision is based on the race between
-            //  the InterlockedIncrement in CsqInsertIo and the
-            //  InterlockedDecrement as below. There are two situations:
-            //
-            //  (1) If the decrement executes earlier before the increment,
-            //      the flag will be decremented to 0 so this worker thread
-            //      will return. Then CsqInsertIo will increment the flag
-            //      from 0 to 1, and therefore create a new worker thread.
-            //  (2) If the increment executes earlier before the decrement,
-            //      the flag will be first incremented to 2 in CsqInsertIo
-            //      so a new worker thread will not be satisfied. Then the
-            //      decrement as below will lower the flag down to 1, and
-            //      therefore continue this worker thread.
+            //  If could not lock the user buffer we cannot
+            //  allow the IO to go below us. Because we are 
+            //  in a different VA space and the buffer is a
+            //  user mode address, we will either fault or 
+            //  corrpt data
             //
+           
+            DebugTrace( CSQ_TRACE_PRE_READ | CSQ_TRACE_ERROR,
+                        ("[Csq]: Failed to lock user buffer (Status = 0x%x)\n",
+                        Status) );
 
-            if (InterlockedDecrement( &InstCtx->WorkerThreadFlag ) == 0) {
-                
-                break;
-            }
-            
+            callbackStatus = FLT_PREOP_COMPLETE;
+            Data->IoStatus.Status = Status;
         }
     }
 
     //
-    //  Clean up
+    //  Complete the I/O
     //
 
-    FltReleaseContext(InstCtx);
+    FltCompletePendedPreOperation( Data,
+                                   callbackStatus,
+                                   NULL );
 
-    FltFreeGenericWorkItem(WorkItem);
+    //
+    //  Free the extra storage that was allocated for this I/O.
+    //
+
+    ExFreeToNPagedLookasideList( &Globals.QueueContextLookaside,
+                                 QueueCtx );
 }
 
 
@@ -1870,7 +2267,7 @@ PreReadEmptyQueueAndComplete(
 
 Routine Description:
 
-    This routine empties the cancel safe queue and complete all the
+    This routine empties the cancel safe queues and complete all the
     pended pre-read operations.
 
 Arguments:
@@ -1883,64 +2280,21 @@ Return Value:
 
 --*/
 {
-    NTSTATUS Status;
-    FLT_PREOP_CALLBACK_STATUS callbackStatus;
     PFLT_CALLBACK_DATA Data;
-    PQUEUE_CONTEXT QueueCtx;
+    ULONG Index;
 
-    do {
+    for (Index = 0; Index < InstanceContext->QueueCount; Index++) {
 
-        callbackStatus = FLT_PREOP_SUCCESS_NO_CALLBACK;
+        do {
 
-        Data = FltCbdqRemoveNextIo( &InstanceContext->Cbdq,
-                                    NULL );
+            Data = FltCbdqRemoveNextIo( &InstanceContext->Queues[Index].Cbdq,
+                                        NULL );
 
-        if (Data) {
+            if (Data) {
 
-            QueueCtx = (PQUEUE_CONTEXT) Data->QueueContext[0];
-
-            //
-            //  Check to see if we need to lock the user buffer.
-            //
-            //  If the FLTFL_CALLBACK_DATA_SYSTEM_BUFFER flag is set we don't 
-            //  have to lock the buffer because its already a system buffer.
-            //
-            //  If the MdlAddress is NULL and the buffer is a user buffer, 
-            //  then we have to construct one in order to look at the buffer.
-            //
-            //  If the length of the buffer is zero there is nothing to read,
-            //  so we cannot construct a MDL.
-            //
-
-            if (!FlagOn(Data->Flags, FLTFL_CALLBACK_DATA_SYSTEM_BUFFER) && 
-                Data->Iopb->Parameters.Read.MdlAddress == NULL &&
-                Data->Iopb->Parameters.Read.Length > 0) {
-
-                Status = FltLockUserBuffer( Data );
-
-                if (!NT_SUCCESS( Status )) {
-
-                    //
-                    //  If could not lock the user buffer we cannot
-                    //  allow the IO to go below us. Because we are 
-                    //  in a different VA space and the buffer is a
-                    //  user mode address, we will either fault or 
-                    //  corrpt data
-                    //
-                   
-                    callbackStatus = FLT_PREOP_COMPLETE;
-                    Data->IoStatus.Status = Status;
-                }
+                PreReadCompleteIo( Data );
             }
 
-            FltCompletePendedPreOperation( Data,
-                                           callbackStatus,
-                                           NULL );
-
-            ExFreeToNPagedLookasideList( &Globals.QueueContextLookaside,
-                                         QueueCtx );
-        }
-
-    } while (Data);
+        } while (Data);
+    }
 }
-
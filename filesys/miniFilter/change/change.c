@@ -37,6 +37,11 @@ Abstract:
     if rollbacked, do not propagate.
 
     4. Properly remove the list at TransactionContextCleanup.
+    
+    Besides the dirty flag, every write records the changed range in the 
+    dirty bitmap of the file and adds the file to the journal of its 
+    volume, see journal.c. A user mode agent reads the journal through 
+    the communication port CG_PORT_NAME.
 
 Environment:
 
@@ -157,6 +162,37 @@ CgProcessTransactionOutcome(
     _Inout_ PCG_TRANSACTION_CONTEXT TransactionContext,
     _In_ ULONG TransactionOutcome
     );
+
+BOOLEAN
+CgGetDirtyRange (
+    _In_ PFLT_CALLBACK_DATA Data,
+    _Out_ PLONGLONG Offset,
+    _Out_ PLONGLONG Length
+    );
+
+NTSTATUS
+CgPortConnect (
+    _In_ PFLT_PORT ClientPort,
+    _In_opt_ PVOID ServerPortCookie,
+    _In_reads_bytes_opt_(SizeOfContext) PVOID ConnectionContext,
+    _In_ ULONG SizeOfContext,
+    _Outptr_result_maybenull_ PVOID *ConnectionCookie
+    );
+
+VOID
+CgPortDisconnect (
+    _In_opt_ PVOID ConnectionCookie
+    );
+
+NTSTATUS
+CgPortMessage (
+    _In_ PVOID PortCookie,
+    _In_reads_bytes_opt_(InputBufferLength) PVOID InputBuffer,
+    _In_ ULONG InputBufferLength,
+    _Out_writes_bytes_to_opt_(OutputBufferLength,*ReturnOutputBufferLength) PVOID OutputBuffer,
+    _In_ ULONG OutputBufferLength,
+    _Out_ PULONG ReturnOutputBufferLength
+    );
     
 
 //
@@ -179,7 +215,20 @@ CgProcessTransactionOutcome(
 #pragma alloc_text(PAGE, CgProcessPreviousTransaction)
 #pragma alloc_text(PAGE, CgProcessTransactionOutcome)
 #pragma alloc_text(PAGE, CgQueryTransactionOutcome)
+#pragma alloc_text(PAGE, CgPortConnect)
+#pragma alloc_text(PAGE, CgPortDisconnect)
+#pragma alloc_text(PAGE, CgPortMessage)
 #endif
+
+//
+//  Communication port used to read the journal, and the single client
+//  connected to it.
+//
+
+#define CG_MAX_VOLUME_NAME_LENGTH       128
+
+static PFLT_PORT gServerPort = NULL;
+static PFLT_PORT gClientPort = NULL;
     
     
 //
@@ -281,7 +330,8 @@ Return Value:
 
 --*/
 {
-    UNREFERENCED_PARAMETER( FltObjects );
+    NTSTATUS status;
+
     UNREFERENCED_PARAMETER( Flags );
     UNREFERENCED_PARAMETER( VolumeDeviceType );
     UNREFERENCED_PARAMETER( VolumeFilesystemType );
@@ -291,6 +341,19 @@ Return Value:
     CG_DBG_PRINT( CGDBG_TRACE_ROUTINES,
                   ("[CG] CgInstanceSetup: Entered\n") );
 
+    //
+    //  Without a journal we still track the dirty flag, so attach anyway.
+    //
+
+    status = CgCreateInstanceContext( FltObjects );
+
+    if (!NT_SUCCESS( status )) {
+
+        CG_DBG_PRINT( CGDBG_TRACE_ERROR,
+                      ("[CG] CgInstanceSetup: Failed to create the journal, status 0x%x\n",
+                       status) );
+    }
+
     return STATUS_SUCCESS;
 }
 
@@ -361,13 +424,29 @@ Return Value:
 
 --*/
 {
-    UNREFERENCED_PARAMETER( FltObjects );
+    NTSTATUS status;
+    PCG_INSTANCE_CONTEXT instanceContext = NULL;
+
     UNREFERENCED_PARAMETER( Flags );
 
     PAGED_CODE();
 
     CG_DBG_PRINT( CGDBG_TRACE_ROUTINES,
                   ("[CG] CgInstanceTeardownStart: Entered\n") );
+
+    //
+    //  Release the file contexts held by the journal, so that they and
+    //  the instance context can go away.
+    //
+
+    status = FltGetInstanceContext( FltObjects->Instance,
+                                    &instanceContext );
+
+    if (NT_SUCCESS( status )) {
+
+        CgDrainJournal( instanceContext );
+        FltReleaseContext( instanceContext );
+    }
 }
 
 
@@ -436,6 +515,9 @@ Return Value:
 --*/
 {
     NTSTATUS status;
+    PSECURITY_DESCRIPTOR sd;
+    OBJECT_ATTRIBUTES oa;
+    UNICODE_STRING uniString;
 
     UNREFERENCED_PARAMETER( RegistryPath );
 
@@ -450,6 +532,40 @@ Return Value:
                                 &FilterRegistration,
                                 &gFilterInstance );
 
+    if (!NT_SUCCESS( status )) {
+
+        return status;
+    }
+
+    //
+    //  Create the port the journal is read through. Only administrators
+    //  and system can connect.
+    //
+
+    status = FltBuildDefaultSecurityDescriptor( &sd, FLT_PORT_ALL_ACCESS );
+
+    if (NT_SUCCESS( status )) {
+
+        RtlInitUnicodeString( &uniString, CG_PORT_NAME );
+
+        InitializeObjectAttributes( &oa,
+                                    &uniString,
+                                    OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                                    NULL,
+                                    sd );
+
+        status = FltCreateCommunicationPort( gFilterInstance,
+                                             &gServerPort,
+                                             &oa,
+                                             NULL,
+                                             CgPortConnect,
+                                             CgPortDisconnect,
+                                             CgPortMessage,
+                                             1 );
+
+        FltFreeSecurityDescriptor( sd );
+    }
+
     if (NT_SUCCESS( status )) {
 
         //
@@ -460,10 +576,15 @@ Return Value:
 
         if (!NT_SUCCESS( status )) {
 
-            FltUnregisterFilter( gFilterInstance );
+            FltCloseCommunicationPort( gServerPort );
         }
     }
 
+    if (!NT_SUCCESS( status )) {
+
+        FltUnregisterFilter( gFilterInstance );
+    }
+
     return status;
 }
 
@@ -497,6 +618,7 @@ Return Value:
     CG_DBG_PRINT( CGDBG_TRACE_ROUTINES,
                   ("[CG] CgUnload: Entered\n") );
 
+    FltCloseCommunicationPort( gServerPort );
     
     FltUnregisterFilter( gFilterInstance );
     gFilterInstance = NULL;
@@ -569,6 +691,117 @@ Return Value:
     return FALSE;
 }
 
+BOOLEAN
+CgGetDirtyRange (
+    _In_ PFLT_CALLBACK_DATA Data,
+    _Out_ PLONGLONG Offset,
+    _Out_ PLONGLONG Length
+    )
+/*++
+
+Routine Description:
+
+    This returns the range of the file an operation that makes the file
+    dirty changes, for one of the operations in CgOperationsNeedDirty.
+    This is non-pageable because it could be called on the paging path
+
+Arguments:
+
+    Data - Pointer to the filter callbackData that is passed to us.
+    
+    Offset - Receives the offset of the range.
+    
+    Length - Receives the length of the range.
+
+Return Value:
+
+    TRUE - If the range is known.
+    FALSE - If the operation has to be treated as changing the whole file.
+
+--*/
+{
+    PFLT_IO_PARAMETER_BLOCK iopb = Data->Iopb;
+    PFILE_ZERO_DATA_INFORMATION zeroData;
+    PFSCTL_OFFLOAD_WRITE_INPUT offloadWrite;
+    LARGE_INTEGER byteOffset;
+
+    *Offset = 0;
+    *Length = 0;
+
+    switch(iopb->MajorFunction) {
+    
+        case IRP_MJ_WRITE:
+            byteOffset = iopb->Parameters.Write.ByteOffset;
+
+            if (byteOffset.HighPart == -1) {
+
+                if (byteOffset.LowPart == FILE_WRITE_TO_END_OF_FILE) {
+
+                    //
+                    //  Appends: the end of file is not known here.
+                    //
+
+                    return FALSE;
+                }
+
+                if (byteOffset.LowPart == FILE_USE_FILE_POINTER_POSITION) {
+
+                    byteOffset = iopb->TargetFileObject->CurrentByteOffset;
+                }
+            }
+
+            *Offset = byteOffset.QuadPart;
+            *Length = iopb->Parameters.Write.Length;
+            return TRUE;
+            
+        case IRP_MJ_FILE_SYSTEM_CONTROL:
+
+            //
+            //  Both are METHOD_BUFFERED, so the input is in the system buffer.
+            //
+
+            switch ( iopb->Parameters.FileSystemControl.Common.FsControlCode ) {
+                case FSCTL_SET_ZERO_DATA:
+                    zeroData = iopb->Parameters.FileSystemControl.Buffered.SystemBuffer;
+
+                    if (zeroData == NULL ||
+                        iopb->Parameters.FileSystemControl.Buffered.InputBufferLength < sizeof( FILE_ZERO_DATA_INFORMATION )) {
+
+                        return FALSE;
+                    }
+
+                    *Offset = zeroData->FileOffset.QuadPart;
+                    *Length = zeroData->BeyondFinalZero.QuadPart - zeroData->FileOffset.QuadPart;
+                    return TRUE;
+
+                case FSCTL_OFFLOAD_WRITE:
+                    offloadWrite = iopb->Parameters.FileSystemControl.Buffered.SystemBuffer;
+
+                    if (offloadWrite == NULL ||
+                        iopb->Parameters.FileSystemControl.Buffered.InputBufferLength < sizeof( FSCTL_OFFLOAD_WRITE_INPUT )) {
+
+                        return FALSE;
+                    }
+
+                    *Offset = offloadWrite->FileOffset;
+                    *Length = offloadWrite->CopyLength;
+                    return TRUE;
+
+                default: break;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    //
+    //  Size changes and raw encrypted writes.
+    //
+
+    return FALSE;
+}
+
 NTSTATUS
 CgQueryTransactionOutcome(
     _In_ PKTRANSACTION Transaction,
@@ -988,6 +1221,8 @@ Return Value:
 {
     NTSTATUS status;
     PCG_FILE_CONTEXT fileContext = NULL;
+    LONGLONG offset;
+    LONGLONG length;
     
     UNREFERENCED_PARAMETER( CompletionContext );
 
@@ -1049,6 +1284,23 @@ Return Value:
         
         fileContext->Dirty = TRUE;
     }
+
+    //
+    //  Record what changed for the journal. Transacted writes are recorded
+    //  too: if the transaction rolls back the range is reported although
+    //  it did not change, which only costs the agent a needless copy.
+    //
+
+    if (CgGetDirtyRange( Data, &offset, &length )) {
+
+        CgMarkDirtyRange( fileContext, offset, length );
+
+    } else {
+
+        CgMarkWholeFileDirty( fileContext );
+    }
+
+    CgJournalFile( fileContext );
     
     FltReleaseContext( fileContext );
 
@@ -1391,3 +1643,252 @@ Return Value:
     return STATUS_SUCCESS;
 }
 
+
+/*************************************************************************
+    Communication port routines.
+*************************************************************************/
+
+NTSTATUS
+CgPortConnect (
+    _In_ PFLT_PORT ClientPort,
+    _In_opt_ PVOID ServerPortCookie,
+    _In_reads_bytes_opt_(SizeOfContext) PVOID ConnectionContext,
+    _In_ ULONG SizeOfContext,
+    _Outptr_result_maybenull_ PVOID *ConnectionCookie
+    )
+/*++
+
+Routine Description:
+
+    This is called when user mode connects to the server port.
+
+Arguments:
+
+    ClientPort - This is the client connection port that will be used to
+        send messages from the filter.
+
+    ServerPortCookie - Unused.
+
+    ConnectionContext - Unused.
+
+    SizeOfContext - Unused.
+
+    ConnectionCookie - Unused.
+
+Return Value:
+
+    STATUS_SUCCESS
+
+--*/
+{
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER( ServerPortCookie );
+    UNREFERENCED_PARAMETER( ConnectionContext );
+    UNREFERENCED_PARAMETER( SizeOfContext );
+
+    FLT_ASSERT( gClientPort == NULL );
+
+    gClientPort = ClientPort;
+    *ConnectionCookie = NULL;
+
+    CG_DBG_PRINT( CGDBG_TRACE_ROUTINES,
+                  ("[CG] CgPortConnect: port=0x%p\n", ClientPort) );
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+CgPortDisconnect (
+    _In_opt_ PVOID ConnectionCookie
+    )
+/*++
+
+Routine Description:
+
+    This is called when the connection is torn down.
+
+Arguments:
+
+    ConnectionCookie - Unused.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER( ConnectionCookie );
+
+    CG_DBG_PRINT( CGDBG_TRACE_ROUTINES,
+                  ("[CG] CgPortDisconnect: port=0x%p\n", gClientPort) );
+
+    FltCloseClientPort( gFilterInstance, &gClientPort );
+}
+
+NTSTATUS
+CgPortMessage (
+    _In_ PVOID PortCookie,
+    _In_reads_bytes_opt_(InputBufferLength) PVOID InputBuffer,
+    _In_ ULONG InputBufferLength,
+    _Out_writes_bytes_to_opt_(OutputBufferLength,*ReturnOutputBufferLength) PVOID OutputBuffer,
+    _In_ ULONG OutputBufferLength,
+    _Out_ PULONG ReturnOutputBufferLength
+    )
+/*++
+
+Routine Description:
+
+    This is called whenever user mode sends a message to the filter. The 
+    input buffer is a CG_COMMAND_MESSAGE naming the volume; the changed 
+    files of that volume are returned in the output buffer.
+
+Arguments:
+
+    PortCookie - Unused.
+
+    InputBuffer - A buffer containing input data, can be NULL if there
+        is no input data.
+
+    InputBufferLength - The size in bytes of the InputBuffer.
+
+    OutputBuffer - A buffer provided by the application that originated
+        the communication in which to store data to be returned to this
+        application.
+
+    OutputBufferLength - The size in bytes of the OutputBuffer.
+
+    ReturnOutputBufferLength - The size in bytes of meaningful data
+        returned in the OutputBuffer.
+
+Return Value:
+
+    Returns the status of processing the message.
+
+--*/
+{
+    NTSTATUS status;
+    CG_COMMAND command;
+    ULONG volumeNameLength;
+    WCHAR volumeNameBuffer[CG_MAX_VOLUME_NAME_LENGTH];
+    UNICODE_STRING volumeName;
+    PFLT_VOLUME volume = NULL;
+    PFLT_INSTANCE instance = NULL;
+    PCG_INSTANCE_CONTEXT instanceContext = NULL;
+
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER( PortCookie );
+
+    *ReturnOutputBufferLength = 0;
+
+    if ((InputBuffer == NULL) ||
+        (InputBufferLength < FIELD_OFFSET( CG_COMMAND_MESSAGE, VolumeName ))) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    //
+    //  The input buffer is raw user mode memory, so capture what we need
+    //  under an exception handler.
+    //
+
+    try  {
+
+        command = ((PCG_COMMAND_MESSAGE) InputBuffer)->Command;
+        volumeNameLength = ((PCG_COMMAND_MESSAGE) InputBuffer)->VolumeNameLength;
+
+        if ((volumeNameLength == 0) ||
+            (volumeNameLength > sizeof( volumeNameBuffer )) ||
+            (volumeNameLength % sizeof( WCHAR ) != 0) ||
+            (volumeNameLength > InputBufferLength - FIELD_OFFSET( CG_COMMAND_MESSAGE, VolumeName ))) {
+
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        RtlCopyMemory( volumeNameBuffer,
+                       ((PCG_COMMAND_MESSAGE) InputBuffer)->VolumeName,
+                       volumeNameLength );
+
+    } except (EXCEPTION_EXECUTE_HANDLER) {
+
+        return GetExceptionCode();
+    }
+
+    if (command != CgGetChangedFiles) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (OutputBuffer == NULL) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    //
+    //  The records hold 64-bit fields.
+    //
+
+    if (!IS_ALIGNED( OutputBuffer, sizeof( ULONGLONG ) )) {
+
+        return STATUS_DATATYPE_MISALIGNMENT;
+    }
+
+    volumeName.Buffer = volumeNameBuffer;
+    volumeName.Length = (USHORT) volumeNameLength;
+    volumeName.MaximumLength = (USHORT) volumeNameLength;
+
+    status = FltGetVolumeFromName( gFilterInstance,
+                                   &volumeName,
+                                   &volume );
+
+    if (!NT_SUCCESS( status )) {
+
+        goto Cleanup;
+    }
+
+    status = FltGetVolumeInstanceFromName( gFilterInstance,
+                                           volume,
+                                           NULL,
+                                           &instance );
+
+    if (!NT_SUCCESS( status )) {
+
+        goto Cleanup;
+    }
+
+    status = FltGetInstanceContext( instance,
+                                    &instanceContext );
+
+    if (!NT_SUCCESS( status )) {
+
+        goto Cleanup;
+    }
+
+    status = CgReadJournal( instanceContext,
+                            OutputBuffer,
+                            OutputBufferLength,
+                            ReturnOutputBufferLength );
+
+Cleanup:
+
+    if (instanceContext != NULL) {
+
+        FltReleaseContext( instanceContext );
+    }
+
+    if (instance != NULL) {
+
+        FltObjectDereference( instance );
+    }
+
+    if (volume != NULL) {
+
+        FltObjectDereference( volume );
+    }
+
+    return status;
+}
+
@@ -24,8 +24,10 @@ Environment:
 
 #include <fltKernel.h>
 #include <suppress.h>
+#include "changeuk.h"
 #include "context.h"
 #include "utility.h"
+#include "journal.h"
 
 #pragma prefast(disable:__WARNING_ENCODE_MEMBER_FUNCTION_POINTER, "Not valid for kernel mode drivers")
 
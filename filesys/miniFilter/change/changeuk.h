@@ -0,0 +1,119 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All Rights Reserved
+
+Module Name:
+
+    changeuk.h
+
+Abstract:
+
+    Header file which contains the structures, type definitions,
+    and constants that are shared between kernel mode and user mode.
+    A user mode agent uses them to read the changed-file journal of
+    a volume through the filter's communication port.
+
+Environment:
+
+    Kernel & user mode
+
+--*/
+
+#ifndef __CHANGEUK_H__
+#define __CHANGEUK_H__
+
+//
+//  Name of the port used to read the journal
+//
+
+#define CG_PORT_NAME                    L"\\ChangeJournalPort"
+
+//
+//  Every file has a dirty bitmap of CG_DIRTY_BITMAP_BITS chunks. Chunks
+//  start at 64KB and double in size when a file grows beyond what the
+//  bitmap covers.
+//
+
+#define CG_DIRTY_BITMAP_BITS            1024
+#define CG_DIRTY_BITMAP_ULONGS          (CG_DIRTY_BITMAP_BITS / 32)
+#define CG_DIRTY_MIN_CHUNK_SHIFT        16
+
+//
+//  Commands sent to the filter
+//
+
+typedef enum _CG_COMMAND {
+
+    //
+    //  Return, and remove from the journal, as many changed files of the
+    //  volume as fit in the output buffer. The output buffer receives a
+    //  CG_CHANGED_FILES_HEADER followed by CG_CHANGED_FILE_RECORDs.
+    //
+
+    CgGetChangedFiles
+
+} CG_COMMAND;
+
+typedef struct _CG_COMMAND_MESSAGE {
+
+    CG_COMMAND Command;
+
+    //
+    //  Length in bytes of the volume name, e.g. "\??\C:" or
+    //  "\Device\HarddiskVolume1".
+    //
+
+    ULONG VolumeNameLength;
+    WCHAR VolumeName[1];
+
+} CG_COMMAND_MESSAGE, *PCG_COMMAND_MESSAGE;
+
+//
+//  The journal of the volume overflowed since the last read and changes
+//  were lost; the agent has to rescan the volume.
+//
+
+#define CG_CHANGED_FILES_FLAG_OVERFLOW  0x00000001
+
+typedef struct _CG_CHANGED_FILES_HEADER {
+
+    ULONG RecordCount;
+    ULONG Flags;
+
+} CG_CHANGED_FILES_HEADER, *PCG_CHANGED_FILES_HEADER;
+
+//
+//  The changed ranges of the file are not known, e.g. after a change of
+//  the file size or a raw encrypted write; the whole file must be copied.
+//
+
+#define CG_CHANGED_FILE_FLAG_WHOLE_FILE 0x00000001
+
+typedef struct _CG_CHANGED_FILE_RECORD {
+
+    //
+    //  File ID; for 64-bit file IDs the upper 64 bits are zero.
+    //
+
+    FILE_ID_128 FileId;
+
+    //
+    //  Position of the record in the journal of the volume.
+    //
+
+    ULONGLONG SequenceNumber;
+
+    ULONG Flags;
+
+    //
+    //  Bit N of DirtyChunks covers the bytes from N << ChunkShift up to
+    //  (N + 1) << ChunkShift.
+    //
+
+    ULONG ChunkShift;
+    ULONG DirtyChunks[CG_DIRTY_BITMAP_ULONGS];
+
+} CG_CHANGED_FILE_RECORD, *PCG_CHANGED_FILE_RECORD;
+
+#endif
+
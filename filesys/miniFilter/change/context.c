@@ -38,6 +38,12 @@ CgTransactionContextCleanup (
     _In_ PFLT_CONTEXT Context,
     _In_ FLT_CONTEXT_TYPE ContextType
     );
+
+VOID
+CgInstanceContextCleanup (
+    _In_ PFLT_CONTEXT Context,
+    _In_ FLT_CONTEXT_TYPE ContextType
+    );
     
 
 #ifdef ALLOC_PRAGMA
@@ -46,6 +52,8 @@ CgTransactionContextCleanup (
 #pragma alloc_text(PAGE, CgFindOrCreateTransactionContext)
 #pragma alloc_text(PAGE, CgFileContextCleanup)
 #pragma alloc_text(PAGE, CgTransactionContextCleanup)
+#pragma alloc_text(PAGE, CgInstanceContextCleanup)
+#pragma alloc_text(PAGE, CgCreateInstanceContext)
 #endif
 	
 //
@@ -66,6 +74,12 @@ const FLT_CONTEXT_REGISTRATION ContextRegistration[] = {
       CG_TRANSACTION_CONTEXT_SIZE,
       CG_TRANSACTION_CONTEXT_TAG },
 
+    { FLT_INSTANCE_CONTEXT,
+      0,
+      CgInstanceContextCleanup,
+      CG_INSTANCE_CONTEXT_SIZE,
+      CG_INSTANCE_CONTEXT_TAG },
+
     { FLT_CONTEXT_END }
 };
 
@@ -112,6 +126,12 @@ Return Value:
                  fileContext,
                  fileContext->Dirty) );
 
+    if (fileContext->InstanceContext != NULL) {
+
+        FltReleaseContext( fileContext->InstanceContext );
+        fileContext->InstanceContext = NULL;
+    }
+
     CG_DBG_PRINT( CGDBG_TRACE_ROUTINES,
                 ("[CG]: File context cleanup complete.\n") );
 
@@ -157,6 +177,60 @@ Return Value:
     transactionContext->Transaction = NULL;
 }
 
+VOID
+CgInstanceContextCleanup (
+    _In_ PFLT_CONTEXT Context,
+    _In_ FLT_CONTEXT_TYPE ContextType
+    )
+/*++
+
+Routine Description:
+
+    This routine is called whenever the instance context is about to be destroyed.
+    Typically we need to clean the data structure inside it.
+
+Arguments:
+
+    Context - Pointer to the PCG_INSTANCE_CONTEXT data structure.
+
+    ContextType - This value should be FLT_INSTANCE_CONTEXT.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PCG_INSTANCE_CONTEXT instanceContext = (PCG_INSTANCE_CONTEXT) Context;
+    
+    PAGED_CODE();
+    
+    UNREFERENCED_PARAMETER( ContextType );
+        
+    CG_DBG_PRINT( CGDBG_TRACE_DEBUG,
+                    ("[CG]: CgInstanceContextCleanup context cleanup entered.\n") );
+
+    //
+    //  The journal holds references to file contexts, which hold references
+    //  to this context, so it must have been emptied at teardown.
+    //
+
+    FLT_ASSERTMSG( "[CG]: Journal is not supposed to hold files at instance context cleanup.!\n", 
+                   0 == instanceContext->JournalCount );
+
+    if (instanceContext->Journal != NULL) {
+
+        ExFreePoolWithTag( instanceContext->Journal, CG_JOURNAL_TAG );
+        instanceContext->Journal = NULL;
+    }
+
+    if (instanceContext->Mutex != NULL) {
+
+        CgFreeMutex( instanceContext->Mutex );
+        instanceContext->Mutex = NULL;
+    }
+}
+
 NTSTATUS
 CgGetFileId (
     _In_ PFLT_INSTANCE Instance,
@@ -331,6 +405,20 @@ Return Value:
         
         RtlCopyMemory( &fileContext->FileID, &fileID, sizeof(fileContext->FileID) ); 
 
+        fileContext->DirtyChunkShift = CG_DIRTY_MIN_CHUNK_SHIFT;
+
+        //
+        //  Hold on to the instance context so writes can reach the journal
+        //  without looking it up. If the instance has no journal, only the
+        //  dirty ranges are tracked.
+        //
+
+        if (!NT_SUCCESS( FltGetInstanceContext( Cbd->Iopb->TargetInstance,
+                                                &fileContext->InstanceContext ) )) {
+
+            fileContext->InstanceContext = NULL;
+        }
+
         //
         //  Set the new context we just allocated on the file object
         //
@@ -442,7 +530,8 @@ Return Value:
     PAGED_CODE();
     
     //
-    //  Allocate a file context
+    //  Allocate a file context. It is non-paged because its dirty bitmap
+    //  is updated on the paging path while the journal lock may be held.
     //
 
     CG_DBG_PRINT( CGDBG_TRACE_ROUTINES,
@@ -451,7 +540,7 @@ Return Value:
     status = FltAllocateContext( gFilterInstance,
                                  FLT_FILE_CONTEXT,
                                  CG_FILE_CONTEXT_SIZE,
-                                 PagedPool,
+                                 NonPagedPoolNx,
                                  &fileContext );
 
     if (!NT_SUCCESS( status )) {
@@ -606,4 +695,91 @@ Return value
     return STATUS_SUCCESS;
 }
 
+NTSTATUS
+CgCreateInstanceContext (
+    _In_ PCFLT_RELATED_OBJECTS FltObjects
+    )
+/*++
+
+Routine Description
+
+    This routine creates the instance context, with an empty journal, and
+    attaches it to the instance.
+    
+Arguments
+
+    FltObjects - Contains the instance to attach the context to.
+
+Return value
+
+    Returns STATUS_SUCCESS if we were able to successfully create and set 
+    the instance context. Returns an appropriate error code on a failure.
+    
+--*/
+{
+    NTSTATUS status;
+    PCG_INSTANCE_CONTEXT instanceContext = NULL;
+    
+    PAGED_CODE();
+
+    //
+    //  The journal is appended to on the paging path, so it is non-paged.
+    //
+
+    status = FltAllocateContext( gFilterInstance,
+                                 FLT_INSTANCE_CONTEXT,
+                                 CG_INSTANCE_CONTEXT_SIZE,
+                                 NonPagedPoolNx,
+                                 &instanceContext );
+
+    if (!NT_SUCCESS( status )) {
+
+        CG_DBG_PRINT( CGDBG_TRACE_ERROR,
+                ("[CG]: Failed to allocate instance context with status 0x%x \n",
+                 status) );
+
+        return status;
+    }
+
+    RtlZeroMemory( instanceContext, CG_INSTANCE_CONTEXT_SIZE );
+
+    instanceContext->Mutex = CgAllocateMutex();
+
+    if (NULL == instanceContext->Mutex) {
+
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Cleanup;
+    }
+
+    ExInitializeFastMutex( instanceContext->Mutex );
+
+    instanceContext->JournalCapacity = CG_JOURNAL_CAPACITY;
+    instanceContext->Journal = ExAllocatePoolWithTag( NonPagedPoolNx,
+                                                      CG_JOURNAL_CAPACITY * sizeof( PCG_FILE_CONTEXT ),
+                                                      CG_JOURNAL_TAG );
+
+    if (NULL == instanceContext->Journal) {
+
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Cleanup;
+    }
+
+    status = FltSetInstanceContext( FltObjects->Instance,
+                                    FLT_SET_CONTEXT_KEEP_IF_EXISTS,
+                                    instanceContext,
+                                    NULL );
+
+    if (!NT_SUCCESS( status )) {
+
+        CG_DBG_PRINT( CGDBG_TRACE_ERROR,
+            ("[CG]: Failed to set instance context with status 0x%x \n",
+             status) );
+    }
+
+Cleanup:
+
+    FltReleaseContext( instanceContext );
+
+    return status;
+}
 
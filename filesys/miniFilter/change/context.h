@@ -23,6 +23,54 @@ Environment:
 
 #define CG_FILE_CONTEXT_TAG                'cFcG'
 #define CG_TRANSACTION_CONTEXT_TAG           'cTcG'
+#define CG_INSTANCE_CONTEXT_TAG              'cIcG'
+
+//
+//  Defines the instance context structure. It holds the journal of the
+//  files of the volume that changed since user mode last read it.
+//
+
+typedef struct _CG_INSTANCE_CONTEXT {
+
+    //
+    //  Ring of referenced file contexts, oldest first. A file is in the
+    //  journal at most once.
+    //
+
+    struct _CG_FILE_CONTEXT **Journal;
+    ULONG JournalCapacity;
+    ULONG JournalHead;
+    ULONG JournalCount;
+
+    //
+    //  Sequence number of the next record.
+    //
+
+    ULONGLONG NextSequence;
+
+    //
+    //  A flag that records if files were dropped from a full journal
+    //  since user mode last read it.
+    //
+
+    BOOLEAN Overflowed;
+
+    //
+    //  A flag that stops new records once the instance is torn down.
+    //
+
+    BOOLEAN TearingDown;
+
+    //
+    //  Lock used to protect the journal and to serialize the resizing
+    //  of dirty bitmaps.
+    //
+
+    PFAST_MUTEX Mutex;
+
+} CG_INSTANCE_CONTEXT, *PCG_INSTANCE_CONTEXT;
+
+#define CG_INSTANCE_CONTEXT_SIZE         sizeof( CG_INSTANCE_CONTEXT )
 
 //
 //  Defines the transaction context structure
@@ -125,6 +173,36 @@ typedef struct _CG_FILE_CONTEXT {
     //
     
     LIST_ENTRY  ListInTransaction;
+
+    //
+    //  Dirty ranges of the file since the journal was last read. Each bit
+    //  covers 1 << DirtyChunkShift bytes. DirtyBitmapSequence is odd while
+    //  the bitmap is being coarsened, so that writers setting bits without
+    //  the lock can tell their bits may have been lost.
+    //
+
+    volatile LONG DirtyChunks[CG_DIRTY_BITMAP_ULONGS];
+    volatile LONG DirtyChunkShift;
+    volatile LONG DirtyBitmapSequence;
+
+    //
+    //  Set when a change could not be tracked as a range.
+    //
+
+    volatile LONG WholeFileDirty;
+
+    //
+    //  Set while the file is in the journal of its instance.
+    //
+
+    volatile LONG InJournal;
+    ULONGLONG JournalSequence;
+
+    //
+    //  Referenced instance context; NULL if the instance has no journal.
+    //
+
+    PCG_INSTANCE_CONTEXT InstanceContext;
     
 } CG_FILE_CONTEXT, *PCG_FILE_CONTEXT;
 
@@ -146,6 +224,11 @@ CgFindOrCreateTransactionContext(
     _Outptr_ PCG_TRANSACTION_CONTEXT *TransactionContext
     );
 
+NTSTATUS
+CgCreateInstanceContext (
+    _In_ PCFLT_RELATED_OBJECTS FltObjects
+    );
+
 
 #endif
 
@@ -0,0 +1,621 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All Rights Reserved
+
+Module Name:
+
+    journal.c
+
+Abstract:
+
+    This module implements the changed-file journal of a volume and the 
+    dirty range bitmaps of its files.
+    
+    Every file context carries a bitmap of the chunks of the file that 
+    were written since user mode last read the file. Writers set bits 
+    with interlocked operations and without any lock. When a write lands
+    beyond what the bitmap covers, the bitmap is coarsened under the 
+    journal lock by doubling the chunk size; a sequence number that is 
+    odd while this happens tells lock-free writers to set their bits again.
+    
+    Every instance context carries a ring of referenced file contexts, 
+    one entry per file that changed, in the order the files first changed.
+    User mode drains the ring through the communication port, many files 
+    per message. When the ring is full the oldest file is dropped and the 
+    journal is flagged as overflowed, so user mode knows to rescan.
+
+Environment:
+
+    Kernel mode
+
+--*/
+
+#include "change.h"
+
+//
+//  Local function prototypes.
+//
+
+VOID
+CgSetDirtyBits (
+    _Inout_ PCG_FILE_CONTEXT FileContext,
+    _In_ ULONG FirstBit,
+    _In_ ULONG LastBit
+    );
+
+VOID
+CgCoarsenDirtyBitmap (
+    _Inout_ PCG_FILE_CONTEXT FileContext,
+    _In_ LONG NewShift
+    );
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, CgDrainJournal)
+#endif
+
+//
+//  Largest chunk shift; past this a change is tracked as a whole-file change.
+//
+
+#define CG_DIRTY_MAX_CHUNK_SHIFT        53
+
+
+VOID
+CgSetDirtyBits (
+    _Inout_ PCG_FILE_CONTEXT FileContext,
+    _In_ ULONG FirstBit,
+    _In_ ULONG LastBit
+    )
+/*++
+
+Routine Description:
+
+    This routine sets a run of bits in the dirty bitmap of the file 
+    without holding any lock.
+
+Arguments:
+
+    FileContext - The file context to set bits for.
+    
+    FirstBit - The first bit to set.
+    
+    LastBit - The last bit to set, inclusive.
+
+Return Value:
+
+    None
+
+--*/
+{
+    ULONG index;
+    ULONG mask;
+
+    for (index = FirstBit / 32; index <= LastBit / 32; index++) {
+
+        mask = MAXULONG;
+
+        if (index == FirstBit / 32) {
+
+            mask &= MAXULONG << (FirstBit % 32);
+        }
+
+        if (index == LastBit / 32) {
+
+            mask &= MAXULONG >> (31 - (LastBit % 32));
+        }
+
+        //
+        //  Skip the interlocked operation if the bits are already set,
+        //  as they are for files rewritten in place.
+        //
+
+        if ((FileContext->DirtyChunks[index] & mask) != mask) {
+
+            InterlockedOr( &FileContext->DirtyChunks[index], (LONG) mask );
+        }
+    }
+}
+
+VOID
+CgCoarsenDirtyBitmap (
+    _Inout_ PCG_FILE_CONTEXT FileContext,
+    _In_ LONG NewShift
+    )
+/*++
+
+Routine Description:
+
+    This routine grows the chunk size of the dirty bitmap of the file and
+    folds the bits it had into the bigger chunks.
+    
+    The caller must hold the journal lock.
+
+Arguments:
+
+    FileContext - The file context to coarsen the bitmap of.
+    
+    NewShift - The new chunk shift, larger than the current one.
+
+Return Value:
+
+    None
+
+--*/
+{
+    ULONG oldBits[CG_DIRTY_BITMAP_ULONGS];
+    ULONG newBits[CG_DIRTY_BITMAP_ULONGS];
+    LONG oldShift = FileContext->DirtyChunkShift;
+    ULONG index;
+    ULONG bit;
+
+    //
+    //  Lock-free writers that overlap with this see an odd or a changed
+    //  sequence number and set their bits again.
+    //
+
+    InterlockedIncrement( &FileContext->DirtyBitmapSequence );
+
+    for (index = 0; index < CG_DIRTY_BITMAP_ULONGS; index++) {
+
+        oldBits[index] = (ULONG) InterlockedExchange( &FileContext->DirtyChunks[index], 0 );
+        newBits[index] = 0;
+    }
+
+    for (bit = 0; bit < CG_DIRTY_BITMAP_BITS; bit++) {
+
+        if (FlagOn( oldBits[bit / 32], 1 << (bit % 32) )) {
+
+            ULONG newBit = bit >> (NewShift - oldShift);
+
+            SetFlag( newBits[newBit / 32], 1 << (newBit % 32) );
+        }
+    }
+
+    InterlockedExchange( &FileContext->DirtyChunkShift, NewShift );
+
+    for (index = 0; index < CG_DIRTY_BITMAP_ULONGS; index++) {
+
+        if (newBits[index] != 0) {
+
+            InterlockedOr( &FileContext->DirtyChunks[index], (LONG) newBits[index] );
+        }
+    }
+
+    InterlockedIncrement( &FileContext->DirtyBitmapSequence );
+}
+
+VOID
+CgMarkDirtyRange (
+    _Inout_ PCG_FILE_CONTEXT FileContext,
+    _In_ LONGLONG Offset,
+    _In_ LONGLONG Length
+    )
+/*++
+
+Routine Description:
+
+    This routine records that a range of the file changed. 
+    
+    This is non-pageable because it could be called on the paging path.
+
+Arguments:
+
+    FileContext - The file context of the file that changed.
+    
+    Offset - The offset of the range.
+    
+    Length - The length of the range in bytes.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PCG_INSTANCE_CONTEXT instanceContext = FileContext->InstanceContext;
+    ULONGLONG lastByte;
+    LONG sequence;
+    LONG shift;
+
+    if (Length <= 0) {
+
+        return;
+    }
+
+    if (Offset < 0 || 
+        (ULONGLONG) Offset + (ULONGLONG) Length < (ULONGLONG) Offset) {
+
+        CgMarkWholeFileDirty( FileContext );
+        return;
+    }
+
+    lastByte = (ULONGLONG) Offset + (ULONGLONG) Length - 1;
+
+    for (;;) {
+
+        sequence = ReadAcquire( &FileContext->DirtyBitmapSequence );
+        shift = ReadNoFence( &FileContext->DirtyChunkShift );
+
+        if (!FlagOn( sequence, 1 ) && 
+            (lastByte >> shift) < CG_DIRTY_BITMAP_BITS) {
+
+            CgSetDirtyBits( FileContext, 
+                            (ULONG) ((ULONGLONG) Offset >> shift), 
+                            (ULONG) (lastByte >> shift) );
+
+            if (ReadAcquire( &FileContext->DirtyBitmapSequence ) == sequence) {
+
+                return;
+            }
+
+            continue;
+        }
+
+        //
+        //  The bitmap is being changed or is too small for the range.
+        //  Changes are serialized by the journal lock; without a journal
+        //  the change can only be tracked as a whole-file change.
+        //
+
+        if (NULL == instanceContext) {
+
+            CgMarkWholeFileDirty( FileContext );
+            return;
+        }
+
+        ExAcquireFastMutex( instanceContext->Mutex );
+
+        shift = FileContext->DirtyChunkShift;
+
+        while ((lastByte >> shift) >= CG_DIRTY_BITMAP_BITS &&
+               shift < CG_DIRTY_MAX_CHUNK_SHIFT) {
+
+            shift++;
+        }
+
+        if ((lastByte >> shift) >= CG_DIRTY_BITMAP_BITS) {
+
+            ExReleaseFastMutex( instanceContext->Mutex );
+            CgMarkWholeFileDirty( FileContext );
+            return;
+        }
+
+        if (shift != FileContext->DirtyChunkShift) {
+
+            CgCoarsenDirtyBitmap( FileContext, shift );
+        }
+
+        ExReleaseFastMutex( instanceContext->Mutex );
+    }
+}
+
+VOID
+CgMarkWholeFileDirty (
+    _Inout_ PCG_FILE_CONTEXT FileContext
+    )
+/*++
+
+Routine Description:
+
+    This routine records that the file changed in a way that cannot be
+    described as a range. 
+    
+    This is non-pageable because it could be called on the paging path.
+
+Arguments:
+
+    FileContext - The file context of the file that changed.
+
+Return Value:
+
+    None
+
+--*/
+{
+    if (0 == ReadNoFence( &FileContext->WholeFileDirty )) {
+
+        InterlockedExchange( &FileContext->WholeFileDirty, 1 );
+    }
+}
+
+VOID
+CgJournalFile (
+    _Inout_ PCG_FILE_CONTEXT FileContext
+    )
+/*++
+
+Routine Description:
+
+    This routine adds the file to the journal of its volume unless it is
+    already there. Callers mark the dirty range first, so a reader that 
+    takes the file out of the journal either sees the range or leaves the 
+    file to be added again.
+    
+    This is non-pageable because it could be called on the paging path.
+
+Arguments:
+
+    FileContext - The file context of the file that changed.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PCG_INSTANCE_CONTEXT instanceContext = FileContext->InstanceContext;
+    PCG_FILE_CONTEXT droppedContext = NULL;
+
+    if (NULL == instanceContext) {
+
+        return;
+    }
+
+    //
+    //  Most writes are to files that are already in the journal; those 
+    //  do not need the lock.
+    //
+
+    if (ReadNoFence( &FileContext->InJournal ) != 0 ||
+        InterlockedCompareExchange( &FileContext->InJournal, 1, 0 ) != 0) {
+
+        return;
+    }
+
+    ExAcquireFastMutex( instanceContext->Mutex );
+
+    if (instanceContext->TearingDown) {
+
+        InterlockedExchange( &FileContext->InJournal, 0 );
+        ExReleaseFastMutex( instanceContext->Mutex );
+        return;
+    }
+
+    if (instanceContext->JournalCount == instanceContext->JournalCapacity) {
+
+        //
+        //  Drop the oldest file. Its changes are lost to user mode until it
+        //  changes again, so user mode has to rescan.
+        //
+
+        droppedContext = instanceContext->Journal[instanceContext->JournalHead];
+        instanceContext->Journal[instanceContext->JournalHead] = NULL;
+        instanceContext->JournalHead = (instanceContext->JournalHead + 1) % instanceContext->JournalCapacity;
+        instanceContext->JournalCount--;
+        instanceContext->Overflowed = TRUE;
+
+        InterlockedExchange( &droppedContext->InJournal, 0 );
+    }
+
+    FltReferenceContext( FileContext );
+
+    FileContext->JournalSequence = instanceContext->NextSequence++;
+    instanceContext->Journal[(instanceContext->JournalHead + instanceContext->JournalCount) % instanceContext->JournalCapacity] = FileContext;
+    instanceContext->JournalCount++;
+
+    ExReleaseFastMutex( instanceContext->Mutex );
+
+    if (droppedContext != NULL) {
+
+        CG_DBG_PRINT( CGDBG_TRACE_DEBUG,
+                      ("[CG]: Journal overflowed, dropped file context %p\n",
+                       droppedContext) );
+
+        FltReleaseContext( droppedContext );
+    }
+}
+
+NTSTATUS
+CgReadJournal (
+    _In_ PCG_INSTANCE_CONTEXT InstanceContext,
+    _Out_writes_bytes_to_(OutputBufferSize,*ReturnOutputBufferLength) PVOID OutputBuffer,
+    _In_ ULONG OutputBufferSize,
+    _Out_ PULONG ReturnOutputBufferLength
+    )
+/*++
+
+Routine Description:
+
+    This routine takes as many files out of the journal as fit in the 
+    output buffer, oldest first, and returns their dirty ranges. The 
+    ranges are cleared as they are returned.
+    
+    This is non-pageable because it holds the journal lock, which is 
+    acquired on the paging path.
+
+Arguments:
+
+    InstanceContext - The instance context of the volume to read.
+    
+    OutputBuffer - The user mode buffer that receives a 
+        CG_CHANGED_FILES_HEADER followed by CG_CHANGED_FILE_RECORDs.
+    
+    OutputBufferSize - The size of the output buffer in bytes.
+    
+    ReturnOutputBufferLength - Receives the number of bytes returned.
+
+Return Value:
+
+    STATUS_SUCCESS if the journal was read, STATUS_BUFFER_TOO_SMALL if 
+    the buffer does not fit the header, or an appropriate error code.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PCG_CHANGED_FILES_HEADER header;
+    PCG_CHANGED_FILE_RECORD record;
+    PCG_FILE_CONTEXT *fileContexts = NULL;
+    PCG_FILE_CONTEXT fileContext;
+    ULONG maxRecords;
+    ULONG recordCount = 0;
+    ULONG bufferSize;
+    ULONG index;
+    ULONG word;
+
+    *ReturnOutputBufferLength = 0;
+
+    if (OutputBufferSize < sizeof( CG_CHANGED_FILES_HEADER )) {
+
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    maxRecords = (OutputBufferSize - sizeof( CG_CHANGED_FILES_HEADER )) / sizeof( CG_CHANGED_FILE_RECORD );
+    maxRecords = min( maxRecords, InstanceContext->JournalCapacity );
+
+    //
+    //  The records are built in a non-paged buffer under the lock and 
+    //  copied to user mode after it is released.
+    //
+
+    bufferSize = sizeof( CG_CHANGED_FILES_HEADER ) + maxRecords * sizeof( CG_CHANGED_FILE_RECORD );
+
+    header = ExAllocatePoolWithTag( NonPagedPoolNx,
+                                    bufferSize + maxRecords * sizeof( PCG_FILE_CONTEXT ),
+                                    CG_JOURNAL_BUFFER_TAG );
+
+    if (NULL == header) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    record = (PCG_CHANGED_FILE_RECORD) (header + 1);
+    fileContexts = (PCG_FILE_CONTEXT *) Add2Ptr( header, bufferSize );
+
+    ExAcquireFastMutex( InstanceContext->Mutex );
+
+    header->Flags = InstanceContext->Overflowed ? CG_CHANGED_FILES_FLAG_OVERFLOW : 0;
+    InstanceContext->Overflowed = FALSE;
+
+    while (recordCount < maxRecords && InstanceContext->JournalCount > 0) {
+
+        fileContext = InstanceContext->Journal[InstanceContext->JournalHead];
+        InstanceContext->Journal[InstanceContext->JournalHead] = NULL;
+        InstanceContext->JournalHead = (InstanceContext->JournalHead + 1) % InstanceContext->JournalCapacity;
+        InstanceContext->JournalCount--;
+
+        //
+        //  Leave the journal before taking the bits, so a write that 
+        //  sets bits after they were taken adds the file again.
+        //
+
+        InterlockedExchange( &fileContext->InJournal, 0 );
+
+        RtlCopyMemory( &record->FileId, 
+                       &fileContext->FileID.FileId128, 
+                       sizeof( record->FileId ) );
+        record->SequenceNumber = fileContext->JournalSequence;
+        record->Flags = InterlockedExchange( &fileContext->WholeFileDirty, 0 ) ? 
+                            CG_CHANGED_FILE_FLAG_WHOLE_FILE : 0;
+
+        //
+        //  Take the bits and go back to the smallest chunks. Writers that 
+        //  set bits at the old chunk size after the bits were taken see
+        //  the sequence number change and set them again.
+        //
+
+        InterlockedIncrement( &fileContext->DirtyBitmapSequence );
+
+        record->ChunkShift = fileContext->DirtyChunkShift;
+
+        for (word = 0; word < CG_DIRTY_BITMAP_ULONGS; word++) {
+
+            record->DirtyChunks[word] = (ULONG) InterlockedExchange( &fileContext->DirtyChunks[word], 0 );
+        }
+
+        InterlockedExchange( &fileContext->DirtyChunkShift, CG_DIRTY_MIN_CHUNK_SHIFT );
+        InterlockedIncrement( &fileContext->DirtyBitmapSequence );
+
+        fileContexts[recordCount] = fileContext;
+        recordCount++;
+        record++;
+    }
+
+    ExReleaseFastMutex( InstanceContext->Mutex );
+
+    header->RecordCount = recordCount;
+    bufferSize = sizeof( CG_CHANGED_FILES_HEADER ) + recordCount * sizeof( CG_CHANGED_FILE_RECORD );
+
+    try {
+
+        RtlCopyMemory( OutputBuffer, header, bufferSize );
+        *ReturnOutputBufferLength = bufferSize;
+
+    } except (EXCEPTION_EXECUTE_HANDLER) {
+
+        status = GetExceptionCode();
+
+        //
+        //  The records are gone from the journal, so user mode has to 
+        //  rescan to find them.
+        //
+
+        if (recordCount > 0) {
+
+            ExAcquireFastMutex( InstanceContext->Mutex );
+            InstanceContext->Overflowed = TRUE;
+            ExReleaseFastMutex( InstanceContext->Mutex );
+        }
+    }
+
+    for (index = 0; index < recordCount; index++) {
+
+        FltReleaseContext( fileContexts[index] );
+    }
+
+    ExFreePoolWithTag( header, CG_JOURNAL_BUFFER_TAG );
+
+    return status;
+}
+
+VOID
+CgDrainJournal (
+    _In_ PCG_INSTANCE_CONTEXT InstanceContext
+    )
+/*++
+
+Routine Description:
+
+    This routine empties the journal at instance teardown and stops it 
+    from taking new files. The journal references the file contexts, 
+    which reference the instance context, so it has to be emptied for 
+    the contexts to be freed.
+
+Arguments:
+
+    InstanceContext - The instance context of the volume.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PCG_FILE_CONTEXT fileContext;
+
+    PAGED_CODE();
+
+    for (;;) {
+
+        ExAcquireFastMutex( InstanceContext->Mutex );
+
+        InstanceContext->TearingDown = TRUE;
+
+        if (0 == InstanceContext->JournalCount) {
+
+            ExReleaseFastMutex( InstanceContext->Mutex );
+            break;
+        }
+
+        fileContext = InstanceContext->Journal[InstanceContext->JournalHead];
+        InstanceContext->Journal[InstanceContext->JournalHead] = NULL;
+        InstanceContext->JournalHead = (InstanceContext->JournalHead + 1) % InstanceContext->JournalCapacity;
+        InstanceContext->JournalCount--;
+
+        InterlockedExchange( &fileContext->InJournal, 0 );
+
+        ExReleaseFastMutex( InstanceContext->Mutex );
+
+        FltReleaseContext( fileContext );
+    }
+}
+
@@ -0,0 +1,62 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All Rights Reserved
+
+Module Name:
+
+    journal.h
+
+Abstract:
+
+    Header file which contains the constants and function prototypes 
+    of the changed-file journal and the per-file dirty range bitmaps.
+
+Environment:
+
+    Kernel mode
+
+--*/
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+#define CG_JOURNAL_TAG                       'jJcG'
+#define CG_JOURNAL_BUFFER_TAG                'bJcG'
+
+//
+//  Number of files each volume journal holds before the oldest is dropped.
+//
+
+#define CG_JOURNAL_CAPACITY                  4096
+
+VOID
+CgMarkDirtyRange (
+    _Inout_ PCG_FILE_CONTEXT FileContext,
+    _In_ LONGLONG Offset,
+    _In_ LONGLONG Length
+    );
+
+VOID
+CgMarkWholeFileDirty (
+    _Inout_ PCG_FILE_CONTEXT FileContext
+    );
+
+VOID
+CgJournalFile (
+    _Inout_ PCG_FILE_CONTEXT FileContext
+    );
+
+NTSTATUS
+CgReadJournal (
+    _In_ PCG_INSTANCE_CONTEXT InstanceContext,
+    _Out_writes_bytes_to_(OutputBufferSize,*ReturnOutputBufferLength) PVOID OutputBuffer,
+    _In_ ULONG OutputBufferSize,
+    _Out_ PULONG ReturnOutputBufferLength
+    );
+
+VOID
+CgDrainJournal (
+    _In_ PCG_INSTANCE_CONTEXT InstanceContext
+    );
+
+#endif
+
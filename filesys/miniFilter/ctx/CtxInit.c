@@ -85,6 +85,11 @@ CtxInitializeDebugLevel (
 
 #endif
 
+VOID
+CtxInitializeContextCacheSetting (
+    _In_ PUNICODE_STRING RegistryPath
+    );
+
 //
 //  Assign text sections for each routine.
 //
@@ -96,6 +101,8 @@ CtxInitializeDebugLevel (
 #pragma alloc_text(INIT, CtxInitializeDebugLevel)
 #endif
 
+#pragma alloc_text(INIT, CtxInitializeContextCacheSetting)
+
 #pragma alloc_text(PAGE, CtxUnload)
 #pragma alloc_text(PAGE, CtxContextCleanup)
 #pragma alloc_text(PAGE, CtxInstanceSetup)
@@ -230,16 +237,23 @@ Return Value:
 
     CtxInitializeDebugLevel( RegistryPath );
 
-#else
-
-    UNREFERENCED_PARAMETER( RegistryPath );
-
 #endif
 
     DebugTrace( DEBUG_TRACE_LOAD_UNLOAD,
                 ("[Ctx]: Driver being loaded\n") );
 
+    //
+    //  Allocate the context caches
+    //
+
+    CtxInitializeContextCacheSetting( RegistryPath );
 
+    status = CtxInitializeContextCaches();
+
+    if (!NT_SUCCESS( status )) {
+
+        return status;
+    }
 
     //
     //  Register with the filter manager
@@ -251,6 +265,7 @@ Return Value:
 
     if (!NT_SUCCESS( status )) {
 
+        CtxFreeContextCaches();
         return status;
     }
 
@@ -263,6 +278,7 @@ Return Value:
     if (!NT_SUCCESS( status )) {
 
         FltUnregisterFilter( Globals.Filter );
+        CtxFreeContextCaches();
     }
 
     DebugTrace( DEBUG_TRACE_LOAD_UNLOAD,
@@ -351,6 +367,71 @@ Return Value:
 
 #endif
 
+VOID
+CtxInitializeContextCacheSetting (
+    _In_ PUNICODE_STRING RegistryPath
+    )
+/*++
+
+Routine Description:
+
+    This routine reads the filter ContextCache parameter from the registry.
+    The per processor context caches are used unless it is present and 0.
+
+Arguments:
+
+    RegistryPath - The path key passed to the driver during DriverEntry.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    OBJECT_ATTRIBUTES attributes;
+    HANDLE driverRegKey;
+    NTSTATUS status;
+    ULONG resultLength;
+    UNICODE_STRING valueName;
+    UCHAR buffer[sizeof( KEY_VALUE_PARTIAL_INFORMATION ) + sizeof( LONG )];
+
+    Globals.ContextCacheEnabled = TRUE;
+
+    InitializeObjectAttributes( &attributes,
+                                RegistryPath,
+                                OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                                NULL,
+                                NULL );
+
+    status = ZwOpenKey( &driverRegKey,
+                        KEY_READ,
+                        &attributes );
+
+    if (NT_SUCCESS( status )) {
+
+        RtlInitUnicodeString( &valueName, L"ContextCache" );
+
+        status = ZwQueryValueKey( driverRegKey,
+                                  &valueName,
+                                  KeyValuePartialInformation,
+                                  buffer,
+                                  sizeof(buffer),
+                                  &resultLength );
+
+        if (NT_SUCCESS( status ) &&
+            (*((PULONG) &(((PKEY_VALUE_PARTIAL_INFORMATION) buffer)->Data)) == 0)) {
+
+            Globals.ContextCacheEnabled = FALSE;
+        }
+
+        ZwClose( driverRegKey );
+    }
+
+    DebugTrace( DEBUG_TRACE_LOAD_UNLOAD,
+                ("[Ctx]: Context caches %s\n",
+                 Globals.ContextCacheEnabled ? "enabled" : "disabled") );
+}
+
 NTSTATUS
 CtxUnload (
     _In_ FLT_FILTER_UNLOAD_FLAGS Flags
@@ -385,6 +466,8 @@ Return Value:
     FltUnregisterFilter( Globals.Filter );
     Globals.Filter = NULL;
 
+    CtxFreeContextCaches();
+
     return STATUS_SUCCESS;
 }
 
@@ -857,6 +940,13 @@ Return Value:
                 ("[Ctx]: Instance teardown complete started (Instance = %p)\n",
                  FltObjects->Instance) );
 
+    //
+    //  No more operations can run on this instance, drop the contexts we
+    //  cached for its file objects.
+    //
+
+    CtxInvalidateCachedContexts( FltObjects->Instance, NULL );
+
     DebugTrace( DEBUG_TRACE_INSTANCE_CONTEXT_OPERATIONS,
                 ("[Ctx]: Getting instance context (Volume = %p, Instance = %p)\n",
                  FltObjects->Volume,
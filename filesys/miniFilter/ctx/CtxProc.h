@@ -128,6 +128,38 @@ CtxUpdateNameInStreamHandleContext (
     _Inout_ PCTX_STREAMHANDLE_CONTEXT StreamHandleContext
     );
 
+NTSTATUS
+CtxInitializeContextCaches (
+    VOID
+    );
+
+VOID
+CtxFreeContextCaches (
+    VOID
+    );
+
+BOOLEAN
+CtxLookupCachedContext (
+    _In_ PFLT_INSTANCE Instance,
+    _In_ PFILE_OBJECT FileObject,
+    _In_ FLT_CONTEXT_TYPE ContextType,
+    _Outptr_result_maybenull_ PFLT_CONTEXT *Context
+    );
+
+VOID
+CtxCacheContext (
+    _In_ PFLT_INSTANCE Instance,
+    _In_ PFILE_OBJECT FileObject,
+    _In_ FLT_CONTEXT_TYPE ContextType,
+    _In_ PFLT_CONTEXT Context
+    );
+
+VOID
+CtxInvalidateCachedContexts (
+    _In_ PFLT_INSTANCE Instance,
+    _In_opt_ PFILE_OBJECT FileObject
+    );
+
 
 //
 //  Functions implemented in support.c
@@ -29,6 +29,56 @@ Environment:
 #define CTX_FILE_CONTEXT_TAG                  'cFxC'
 #define CTX_STREAM_CONTEXT_TAG                'cSxC'
 #define CTX_STREAMHANDLE_CONTEXT_TAG          'cHxC'
+#define CTX_CONTEXT_CACHE_TAG                 'cCxC'
+
+
+//
+//  Context cache
+//
+//  Looking up a stream or file context in Filter Manager is done on nearly
+//  every operation. Each processor keeps a small direct-mapped cache of the
+//  contexts last looked up, keyed on the instance and file object. An entry
+//  holds a reference on its contexts.
+//
+//  The key is the file object and not the stream (FsContext): a cached
+//  reference keeps the context from being cleaned up, so the entries must
+//  be dropped before the stream can go away and its FsContext be reused.
+//  Entries for a file object are dropped in its pre-close, after which no
+//  other operation can be issued on it, and entries for an instance when it
+//  is torn down.
+//
+
+#define CTX_CONTEXT_CACHE_SIZE                64  // entries per processor, a power of two
+
+typedef struct _CTX_CONTEXT_CACHE_ENTRY {
+
+    PFLT_INSTANCE Instance;
+    PFILE_OBJECT FileObject;
+
+    //
+    //  Referenced contexts, either may be NULL
+    //
+
+    PFLT_CONTEXT StreamContext;
+    PFLT_CONTEXT FileContext;
+
+} CTX_CONTEXT_CACHE_ENTRY, *PCTX_CONTEXT_CACHE_ENTRY;
+
+typedef struct DECLSPEC_CACHEALIGN _CTX_CONTEXT_CACHE {
+
+    //
+    //  Lock protecting the entries. Lookups are done by the owning processor,
+    //  invalidations by any processor.
+    //
+
+    KSPIN_LOCK Lock;
+
+    ULONG Hits;
+    ULONG Misses;
+
+    CTX_CONTEXT_CACHE_ENTRY Entries[CTX_CONTEXT_CACHE_SIZE];
+
+} CTX_CONTEXT_CACHE, *PCTX_CONTEXT_CACHE;
 
 
 //
@@ -42,6 +92,20 @@ typedef struct _CTX_GLOBAL_DATA {
     //
 
     PFLT_FILTER Filter;
+
+    //
+    //  Per processor context caches, see CTX_CONTEXT_CACHE
+    //
+
+    PCTX_CONTEXT_CACHE ContextCaches;
+    ULONG ContextCacheCount;
+
+    //
+    //  FALSE if the "ContextCache" registry value is 0, to measure what the
+    //  caches save. They are still allocated but stay empty.
+    //
+
+    BOOLEAN ContextCacheEnabled;
     
 #if DBG
 
@@ -0,0 +1,744 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+Module Name:
+
+    ctxBench.c
+
+Abstract:
+
+    This is a user mode benchmark for the per processor context caches of
+    the ctx sample.  It loads the filter with the caches enabled, runs
+    storms of the operations ctx looks up stream and file contexts for,
+    loads it again with the caches disabled through the ContextCache
+    registry value, runs the storms again, and reports both results and
+    the time the caches save.
+
+    The storms are open and close of a file, where each of post-create,
+    pre-cleanup and pre-close looks up the stream context of the same file
+    object, and renames on an open handle, where post-set-information looks
+    up both the stream and the file context.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <windows.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fltuser.h>
+#include <dontuse.h>
+
+//
+//  Defaults for the command line parameters, and the shape of the storms.
+//
+
+#define CTXBENCH_DEFAULT_ITERATIONS         10000
+#define CTXBENCH_DEFAULT_PASSES             5
+#define CTXBENCH_FILTER_NAME                L"ctx"
+#define CTXBENCH_PARAMETERS_KEY             L"SYSTEM\\CurrentControlSet\\Services\\ctx"
+#define CTXBENCH_CACHE_VALUE                L"ContextCache"
+#define CTXBENCH_WORK_DIRECTORY             L"ctxBench.tmp"
+#define CTXBENCH_INSTANCE_NAME_SIZE         (INSTANCE_NAME_MAX_CHARS + 1)
+
+typedef enum _CTXBENCH_OPERATION {
+
+    BenchOpen,
+    BenchRename,
+    BenchOperationCount
+
+} CTXBENCH_OPERATION;
+
+const PCSTR OperationNames[BenchOperationCount] = {
+
+    "open/close",
+    "rename"
+};
+
+//
+//  State shared by the storms.
+//
+
+typedef struct _CTXBENCH_CONTEXT {
+
+    //
+    //  The directory the storms run in, and the two names the file in it
+    //  is renamed between.
+    //
+
+    WCHAR Directory[MAX_PATH];
+    WCHAR FileName[MAX_PATH];
+    WCHAR OtherFileName[MAX_PATH];
+
+    WCHAR VolumeName[MAX_PATH];
+
+    ULONG Iterations;
+    ULONG Passes;
+
+    LARGE_INTEGER Frequency;
+
+} CTXBENCH_CONTEXT, *PCTXBENCH_CONTEXT;
+
+
+VOID
+Usage (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Prints usage
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+{
+    printf( "Measures what the per processor context caches of ctx save\n" );
+    printf( "Usage: ctxBench <directory> [iterations] [passes]\n" );
+    printf( "    ctx is unloaded and loaded once with each setting of its\n" );
+    printf( "    ContextCache parameter. The parameter is put back, and the\n" );
+    printf( "    filter left loaded, or not, as it was found.\n" );
+    printf( "    Defaults: %u iterations, %u passes\n",
+            CTXBENCH_DEFAULT_ITERATIONS,
+            CTXBENCH_DEFAULT_PASSES );
+}
+
+
+BOOL
+EnableLoadDriverPrivilege (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    FilterLoad and FilterUnload need SeLoadDriverPrivilege enabled, which
+    an elevated process has but not enabled.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    TRUE if the privilege was enabled.
+
+--*/
+{
+    TOKEN_PRIVILEGES privileges;
+    HANDLE token;
+    BOOL result;
+
+    if (!OpenProcessToken( GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES, &token )) {
+
+        return FALSE;
+    }
+
+    privileges.PrivilegeCount = 1;
+    privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+    result = LookupPrivilegeValueW( NULL, SE_LOAD_DRIVER_NAME, &privileges.Privileges[0].Luid ) &&
+             AdjustTokenPrivileges( token, FALSE, &privileges, 0, NULL, NULL ) &&
+             (GetLastError() == ERROR_SUCCESS);
+
+    CloseHandle( token );
+
+    return result;
+}
+
+
+BOOL
+LoadFilter (
+    _In_ PCTXBENCH_CONTEXT Context,
+    _In_ DWORD CacheSetting
+    )
+/*++
+
+Routine Description:
+
+    This sets the ContextCache parameter, loads ctx again so that it reads
+    it, and makes sure it is attached to the volume the storms run on.
+
+Arguments:
+
+    Context - The benchmark context.
+
+    CacheSetting - The ContextCache value to load the filter with.
+
+Return Value:
+
+    TRUE if the filter is loaded and attached.
+
+--*/
+{
+    WCHAR instanceName[CTXBENCH_INSTANCE_NAME_SIZE];
+    HRESULT hResult;
+    LSTATUS status;
+
+    status = RegSetKeyValueW( HKEY_LOCAL_MACHINE,
+                              CTXBENCH_PARAMETERS_KEY,
+                              CTXBENCH_CACHE_VALUE,
+                              REG_DWORD,
+                              &CacheSetting,
+                              sizeof( CacheSetting ) );
+
+    if (status != ERROR_SUCCESS) {
+
+        printf( "ERROR: Could not set %S: %d\n", CTXBENCH_CACHE_VALUE, status );
+        return FALSE;
+    }
+
+    //
+    //  The filter may not be loaded yet.
+    //
+
+    FilterUnload( CTXBENCH_FILTER_NAME );
+
+    hResult = FilterLoad( CTXBENCH_FILTER_NAME );
+
+    if (FAILED( hResult )) {
+
+        printf( "ERROR: Could not load %S: 0x%08x\n", CTXBENCH_FILTER_NAME, hResult );
+        return FALSE;
+    }
+
+    //
+    //  ctx has a default instance and attaches itself to new volumes, but
+    //  not necessarily to the ones mounted before it was loaded.
+    //
+
+    hResult = FilterAttach( CTXBENCH_FILTER_NAME,
+                            Context->VolumeName,
+                            NULL,
+                            sizeof( instanceName ),
+                            instanceName );
+
+    if (FAILED( hResult ) &&
+        (hResult != HRESULT_FROM_WIN32( ERROR_FLT_INSTANCE_ALTITUDE_COLLISION )) &&
+        (hResult != HRESULT_FROM_WIN32( ERROR_FLT_INSTANCE_NAME_COLLISION ))) {
+
+        printf( "ERROR: Could not attach %S to %S: 0x%08x\n",
+                CTXBENCH_FILTER_NAME,
+                Context->VolumeName,
+                hResult );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+BOOL
+PrepareFiles (
+    _In_ PCTXBENCH_CONTEXT Context
+    )
+/*++
+
+Routine Description:
+
+    This creates the work directory and the file the storms operate on.
+
+Arguments:
+
+    Context - The benchmark context.
+
+Return Value:
+
+    TRUE if the file was created.
+
+--*/
+{
+    HANDLE file;
+
+    if (!CreateDirectoryW( Context->Directory, NULL ) &&
+        (GetLastError() != ERROR_ALREADY_EXISTS)) {
+
+        printf( "ERROR: Could not create %S: %d\n", Context->Directory, GetLastError() );
+        return FALSE;
+    }
+
+    DeleteFileW( Context->OtherFileName );
+
+    file = CreateFileW( Context->FileName,
+                        GENERIC_WRITE,
+                        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                        NULL,
+                        CREATE_ALWAYS,
+                        FILE_ATTRIBUTE_NORMAL,
+                        NULL );
+
+    if (file == INVALID_HANDLE_VALUE) {
+
+        printf( "ERROR: Could not create %S: %d\n", Context->FileName, GetLastError() );
+        return FALSE;
+    }
+
+    CloseHandle( file );
+
+    return TRUE;
+}
+
+
+VOID
+CleanupFiles (
+    _In_ PCTXBENCH_CONTEXT Context
+    )
+/*++
+
+Routine Description:
+
+    This deletes the file the storms operated on and the work directory.
+
+Arguments:
+
+    Context - The benchmark context.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    DeleteFileW( Context->FileName );
+    DeleteFileW( Context->OtherFileName );
+    RemoveDirectoryW( Context->Directory );
+}
+
+
+BOOL
+Rename (
+    _In_ HANDLE File,
+    _In_ PCWSTR NewName
+    )
+/*++
+
+Routine Description:
+
+    This renames an open file.
+
+Arguments:
+
+    File - Handle to the file, opened with DELETE access.
+
+    NewName - The full path of the new name.
+
+Return Value:
+
+    TRUE if the file was renamed.
+
+--*/
+{
+    UCHAR buffer[sizeof( FILE_RENAME_INFO ) + MAX_PATH * sizeof( WCHAR )];
+    PFILE_RENAME_INFO renameInfo = (PFILE_RENAME_INFO)buffer;
+    size_t length = wcslen( NewName );
+
+    ZeroMemory( buffer, sizeof( buffer ) );
+
+    renameInfo->ReplaceIfExists = TRUE;
+    renameInfo->RootDirectory = NULL;
+    renameInfo->FileNameLength = (DWORD)(length * sizeof( WCHAR ));
+    CopyMemory( renameInfo->FileName, NewName, length * sizeof( WCHAR ) );
+
+    return SetFileInformationByHandle( File,
+                                       FileRenameInfo,
+                                       renameInfo,
+                                       sizeof( buffer ) );
+}
+
+
+ULONG
+StormLength (
+    _In_ PCTXBENCH_CONTEXT Context,
+    _In_ CTXBENCH_OPERATION Operation
+    )
+/*++
+
+Routine Description:
+
+    Returns the number of operations in a storm. A rename storm is twice
+    the iterations, so that it leaves the file under its first name.
+
+--*/
+{
+    return (Operation == BenchRename) ? Context->Iterations * 2 : Context->Iterations;
+}
+
+
+BOOL
+RunStorm (
+    _In_ PCTXBENCH_CONTEXT Context,
+    _In_ CTXBENCH_OPERATION Operation,
+    _Out_ PLONGLONG Ticks
+    )
+/*++
+
+Routine Description:
+
+    This runs one storm of the given operation and measures how long it
+    takes.
+
+Arguments:
+
+    Context - The benchmark context.
+
+    Operation - The operation to repeat.
+
+    Ticks - Receives the performance counter ticks the storm took.
+
+Return Value:
+
+    TRUE if every operation of the storm succeeded.
+
+--*/
+{
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    HANDLE file = INVALID_HANDLE_VALUE;
+    BOOL result = TRUE;
+    ULONG index;
+
+    *Ticks = 0;
+
+    //
+    //  Renames go to an open handle so that the open isn't measured. They
+    //  go back and forth between two names, and an even number of them
+    //  leaves the file under its first name.
+    //
+
+    if (Operation == BenchRename) {
+
+        file = CreateFileW( Context->FileName,
+                            DELETE | SYNCHRONIZE,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                            NULL,
+                            OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL,
+                            NULL );
+
+        if (file == INVALID_HANDLE_VALUE) {
+
+            printf( "ERROR: Could not open %S: %d\n", Context->FileName, GetLastError() );
+            return FALSE;
+        }
+    }
+
+    QueryPerformanceCounter( &start );
+
+    for (index = 0; (index < StormLength( Context, Operation )) && result; index++) {
+
+        switch (Operation) {
+
+        case BenchOpen:
+
+            file = CreateFileW( Context->FileName,
+                                GENERIC_READ,
+                                FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                NULL,
+                                OPEN_EXISTING,
+                                FILE_ATTRIBUTE_NORMAL,
+                                NULL );
+
+            if (file == INVALID_HANDLE_VALUE) {
+
+                result = FALSE;
+                break;
+            }
+
+            CloseHandle( file );
+            file = INVALID_HANDLE_VALUE;
+            break;
+
+        case BenchRename:
+
+            result = Rename( file, (index & 1) ? Context->FileName : Context->OtherFileName );
+            break;
+
+        default:
+
+            result = FALSE;
+            break;
+        }
+    }
+
+    QueryPerformanceCounter( &end );
+
+    if (!result) {
+
+        printf( "ERROR: %s failed: %d\n", OperationNames[Operation], GetLastError() );
+    }
+
+    if (file != INVALID_HANDLE_VALUE) {
+
+        CloseHandle( file );
+    }
+
+    *Ticks = end.QuadPart - start.QuadPart;
+    return result;
+}
+
+
+BOOL
+MeasureOperations (
+    _In_ PCTXBENCH_CONTEXT Context,
+    _Out_writes_(BenchOperationCount) double *Nanoseconds
+    )
+/*++
+
+Routine Description:
+
+    This runs every storm Context->Passes times and keeps the fastest pass
+    of each, which is the one least disturbed by the rest of the system.
+
+Arguments:
+
+    Context - The benchmark context.
+
+    Nanoseconds - Receives the time per operation of each storm.
+
+Return Value:
+
+    TRUE if every storm succeeded.
+
+--*/
+{
+    LONGLONG ticks;
+    LONGLONG best;
+    ULONG operation;
+    ULONG pass;
+
+    for (operation = 0; operation < BenchOperationCount; operation++) {
+
+        //
+        //  The first storm is not measured. It brings the file, the
+        //  directory and the code paths into the caches.
+        //
+
+        if (!RunStorm( Context, (CTXBENCH_OPERATION)operation, &ticks )) {
+
+            return FALSE;
+        }
+
+        best = MAXLONGLONG;
+
+        for (pass = 0; pass < Context->Passes; pass++) {
+
+            if (!RunStorm( Context, (CTXBENCH_OPERATION)operation, &ticks )) {
+
+                return FALSE;
+            }
+
+            best = min( best, ticks );
+        }
+
+        Nanoseconds[operation] = ((double)best * 1000000000.0) /
+                                 ((double)Context->Frequency.QuadPart *
+                                  StormLength( Context, (CTXBENCH_OPERATION)operation ));
+    }
+
+    return TRUE;
+}
+
+
+int _cdecl
+wmain (
+    _In_ int argc,
+    _In_reads_(argc) WCHAR *argv[]
+    )
+{
+    PCTXBENCH_CONTEXT context = NULL;
+    double cached[BenchOperationCount];
+    double uncached[BenchOperationCount];
+    DWORD savedSetting = 1;
+    DWORD savedSize = sizeof( savedSetting );
+    BOOLEAN settingSaved;
+    BOOLEAN wasLoaded = FALSE;
+    BOOLEAN filesCreated = FALSE;
+    HANDLE findHandle;
+    UCHAR findBuffer[sizeof( FILTER_AGGREGATE_BASIC_INFORMATION ) + MAX_PATH * sizeof( WCHAR )];
+    DWORD bytesReturned;
+    size_t length;
+    ULONG operation;
+    int returnValue = 1;
+
+    if ((argc < 2) || (argc > 4)) {
+
+        Usage();
+        return 1;
+    }
+
+    context = calloc( 1, sizeof( CTXBENCH_CONTEXT ) );
+
+    if (context == NULL) {
+
+        printf( "ERROR: Out of memory\n" );
+        return 1;
+    }
+
+    context->Iterations = (argc > 2) ? wcstoul( argv[2], NULL, 10 ) : CTXBENCH_DEFAULT_ITERATIONS;
+    context->Passes = (argc > 3) ? wcstoul( argv[3], NULL, 10 ) : CTXBENCH_DEFAULT_PASSES;
+
+    if ((context->Iterations == 0) || (context->Passes == 0)) {
+
+        Usage();
+        goto main_cleanup;
+    }
+
+    if (!EnableLoadDriverPrivilege()) {
+
+        printf( "ERROR: Could not enable %S, run as Administrator\n", SE_LOAD_DRIVER_NAME );
+        goto main_cleanup;
+    }
+
+    QueryPerformanceFrequency( &context->Frequency );
+
+    swprintf_s( context->Directory, MAX_PATH, L"%s\\%s", argv[1], CTXBENCH_WORK_DIRECTORY );
+    swprintf_s( context->FileName, MAX_PATH, L"%s\\file.dat", context->Directory );
+    swprintf_s( context->OtherFileName, MAX_PATH, L"%s\\renamed.dat", context->Directory );
+
+    //
+    //  FltMgr names volumes by drive letter without the trailing backslash,
+    //  for example "C:".
+    //
+
+    if (!GetVolumePathNameW( argv[1], context->VolumeName, MAX_PATH )) {
+
+        printf( "ERROR: Could not find the volume of %S: %d\n", argv[1], GetLastError() );
+        goto main_cleanup;
+    }
+
+    length = wcslen( context->VolumeName );
+
+    if ((length > 0) && (context->VolumeName[length - 1] == L'\\')) {
+
+        context->VolumeName[length - 1] = UNICODE_NULL;
+    }
+
+    //
+    //  Remember how the filter was found, so that it can be left that way.
+    //
+
+    settingSaved = (RegGetValueW( HKEY_LOCAL_MACHINE,
+                                  CTXBENCH_PARAMETERS_KEY,
+                                  CTXBENCH_CACHE_VALUE,
+                                  RRF_RT_REG_DWORD,
+                                  NULL,
+                                  &savedSetting,
+                                  &savedSize ) == ERROR_SUCCESS);
+
+    if (SUCCEEDED( FilterFindFirst( FilterAggregateBasicInformation,
+                                    findBuffer,
+                                    sizeof( findBuffer ),
+                                    &bytesReturned,
+                                    &findHandle ) )) {
+
+        do {
+
+            PFILTER_AGGREGATE_BASIC_INFORMATION info = (PFILTER_AGGREGATE_BASIC_INFORMATION)findBuffer;
+
+            if ((info->Flags & FLTFL_AGGREGATE_INFO_IS_MINIFILTER) &&
+                (info->Type.MiniFilter.FilterNameLength == wcslen( CTXBENCH_FILTER_NAME ) * sizeof( WCHAR )) &&
+                (_wcsnicmp( (PWCHAR)((PUCHAR)info + info->Type.MiniFilter.FilterNameBufferOffset),
+                            CTXBENCH_FILTER_NAME,
+                            wcslen( CTXBENCH_FILTER_NAME ) ) == 0)) {
+
+                wasLoaded = TRUE;
+            }
+
+        } while (!wasLoaded &&
+                 SUCCEEDED( FilterFindNext( findHandle,
+                                            FilterAggregateBasicInformation,
+                                            findBuffer,
+                                            sizeof( findBuffer ),
+                                            &bytesReturned ) ));
+
+        FilterFindClose( findHandle );
+    }
+
+    if (!PrepareFiles( context )) {
+
+        goto main_cleanup;
+    }
+
+    filesCreated = TRUE;
+
+    printf( "Measuring %S on %S, %u iterations, best of %u passes\n",
+            CTXBENCH_FILTER_NAME,
+            context->VolumeName,
+            context->Iterations,
+            context->Passes );
+
+    if (!LoadFilter( context, 1 ) ||
+        !MeasureOperations( context, cached )) {
+
+        goto main_cleanup;
+    }
+
+    if (!LoadFilter( context, 0 ) ||
+        !MeasureOperations( context, uncached )) {
+
+        goto main_cleanup;
+    }
+
+    printf( "\n%-16s %14s %14s %14s\n", "operation", "cache off ns", "cache on ns", "saved ns" );
+
+    for (operation = 0; operation < BenchOperationCount; operation++) {
+
+        printf( "%-16s %14.0f %14.0f %14.0f (%+.1f%%)\n",
+                OperationNames[operation],
+                uncached[operation],
+                cached[operation],
+                uncached[operation] - cached[operation],
+                ((uncached[operation] - cached[operation]) * 100.0) / uncached[operation] );
+    }
+
+    returnValue = 0;
+
+main_cleanup:
+
+    //
+    //  Put the parameter back, and load the filter with it or leave it
+    //  unloaded.
+    //
+
+    if (filesCreated) {
+
+        if (settingSaved) {
+
+            RegSetKeyValueW( HKEY_LOCAL_MACHINE,
+                             CTXBENCH_PARAMETERS_KEY,
+                             CTXBENCH_CACHE_VALUE,
+                             REG_DWORD,
+                             &savedSetting,
+                             sizeof( savedSetting ) );
+
+        } else {
+
+            RegDeleteKeyValueW( HKEY_LOCAL_MACHINE,
+                                CTXBENCH_PARAMETERS_KEY,
+                                CTXBENCH_CACHE_VALUE );
+        }
+
+        FilterUnload( CTXBENCH_FILTER_NAME );
+
+        if (wasLoaded) {
+
+            FilterLoad( CTXBENCH_FILTER_NAME );
+        }
+
+        CleanupFiles( context );
+    }
+
+    free( context );
+
+    return returnValue;
+}
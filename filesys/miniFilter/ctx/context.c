@@ -32,6 +32,8 @@ Environment:
 #pragma alloc_text(PAGE, CtxCreateOrReplaceStreamHandleContext)
 #pragma alloc_text(PAGE, CtxCreateStreamHandleContext)
 #pragma alloc_text(PAGE, CtxUpdateNameInStreamHandleContext)
+#pragma alloc_text(PAGE, CtxInitializeContextCaches)
+#pragma alloc_text(PAGE, CtxFreeContextCaches)
 #endif
 
 
@@ -78,7 +80,21 @@ Return Value:
     if (ContextCreated != NULL) *ContextCreated = FALSE;
 
     //
-    //  First try to get the file context.
+    //  See if this processor has the file context cached.
+    //
+
+    if (CtxLookupCachedContext( Cbd->Iopb->TargetInstance,
+                                Cbd->Iopb->TargetFileObject,
+                                FLT_FILE_CONTEXT,
+                                (PFLT_CONTEXT *) &fileContext )) {
+
+        *FileContext = fileContext;
+
+        return STATUS_SUCCESS;
+    }
+
+    //
+    //  Try to get the file context.
     //
 
     DebugTrace( DEBUG_TRACE_FILE_CONTEXT_OPERATIONS,
@@ -205,6 +221,14 @@ Return Value:
         }
     }
 
+    if (NT_SUCCESS( status )) {
+
+        CtxCacheContext( Cbd->Iopb->TargetInstance,
+                         Cbd->Iopb->TargetFileObject,
+                         FLT_FILE_CONTEXT,
+                         fileContext );
+    }
+
     *FileContext = fileContext;
 
     return status;
@@ -319,7 +343,21 @@ Return Value:
     if (ContextCreated != NULL) *ContextCreated = FALSE;
 
     //
-    //  First try to get the stream context.
+    //  See if this processor has the stream context cached.
+    //
+
+    if (CtxLookupCachedContext( Cbd->Iopb->TargetInstance,
+                                Cbd->Iopb->TargetFileObject,
+                                FLT_STREAM_CONTEXT,
+                                (PFLT_CONTEXT *) &streamContext )) {
+
+        *StreamContext = streamContext;
+
+        return STATUS_SUCCESS;
+    }
+
+    //
+    //  Try to get the stream context.
     //
 
     DebugTrace( DEBUG_TRACE_STREAM_CONTEXT_OPERATIONS,
@@ -446,6 +484,14 @@ Return Value:
         }
     }
 
+    if (NT_SUCCESS( status )) {
+
+        CtxCacheContext( Cbd->Iopb->TargetInstance,
+                         Cbd->Iopb->TargetFileObject,
+                         FLT_STREAM_CONTEXT,
+                         streamContext );
+    }
+
     *StreamContext = streamContext;
 
     return status;
@@ -883,3 +929,358 @@ Note:
     return status;
 }
 
+
+//
+//  Context cache support. These routines are called at IRQL <= APC_LEVEL but
+//  run at DISPATCH_LEVEL while holding the cache locks, so they are not
+//  pageable.
+//
+
+FORCEINLINE
+ULONG
+CtxContextCacheIndex (
+    _In_ PFILE_OBJECT FileObject
+    )
+{
+    ULONG_PTR key = (ULONG_PTR) FileObject;
+
+    return (ULONG) ((key >> 4) ^ (key >> 12)) & (CTX_CONTEXT_CACHE_SIZE - 1);
+}
+
+
+NTSTATUS
+CtxInitializeContextCaches (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    This routine allocates the per processor context caches.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    Status
+
+--*/
+{
+    ULONG i;
+
+    PAGED_CODE();
+
+    Globals.ContextCacheCount = KeQueryMaximumProcessorCountEx( ALL_PROCESSOR_GROUPS );
+
+    Globals.ContextCaches = ExAllocatePoolWithTag( NonPagedPool,
+                                                   Globals.ContextCacheCount * sizeof( CTX_CONTEXT_CACHE ),
+                                                   CTX_CONTEXT_CACHE_TAG );
+
+    if (Globals.ContextCaches == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory( Globals.ContextCaches,
+                   Globals.ContextCacheCount * sizeof( CTX_CONTEXT_CACHE ) );
+
+    for (i = 0; i < Globals.ContextCacheCount; i++) {
+
+        KeInitializeSpinLock( &Globals.ContextCaches[i].Lock );
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+CtxFreeContextCaches (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    This routine frees the per processor context caches. All instances have
+    been torn down by now, so they are empty.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+{
+    ULONG i;
+
+    PAGED_CODE();
+
+    if (Globals.ContextCaches == NULL) {
+
+        return;
+    }
+
+    for (i = 0; i < Globals.ContextCacheCount; i++) {
+
+        DebugTrace( DEBUG_TRACE_LOAD_UNLOAD,
+                    ("[Ctx]: Context cache of processor %d: %d hits, %d misses\n",
+                     i,
+                     Globals.ContextCaches[i].Hits,
+                     Globals.ContextCaches[i].Misses) );
+    }
+
+    ExFreePoolWithTag( Globals.ContextCaches,
+                       CTX_CONTEXT_CACHE_TAG );
+
+    Globals.ContextCaches = NULL;
+}
+
+
+BOOLEAN
+CtxLookupCachedContext (
+    _In_ PFLT_INSTANCE Instance,
+    _In_ PFILE_OBJECT FileObject,
+    _In_ FLT_CONTEXT_TYPE ContextType,
+    _Outptr_result_maybenull_ PFLT_CONTEXT *Context
+    )
+/*++
+
+Routine Description:
+
+    This routine looks up a stream or file context in the context cache of
+    the current processor.
+
+Arguments:
+
+    Instance              - Supplies the instance
+    FileObject            - Supplies the file object
+    ContextType           - Supplies FLT_STREAM_CONTEXT or FLT_FILE_CONTEXT
+    Context               - Returns the referenced context, if cached
+
+Return Value:
+
+    TRUE if the context was found in the cache
+
+--*/
+{
+    PCTX_CONTEXT_CACHE cache;
+    PCTX_CONTEXT_CACHE_ENTRY entry;
+    PFLT_CONTEXT context = NULL;
+    KIRQL oldIrql;
+
+    FLT_ASSERT( (ContextType == FLT_STREAM_CONTEXT) || (ContextType == FLT_FILE_CONTEXT) );
+
+    if (!Globals.ContextCacheEnabled) {
+
+        *Context = NULL;
+        return FALSE;
+    }
+
+    KeRaiseIrql( DISPATCH_LEVEL, &oldIrql );
+
+    cache = &Globals.ContextCaches[KeGetCurrentProcessorNumberEx( NULL )];
+    entry = &cache->Entries[CtxContextCacheIndex( FileObject )];
+
+    KeAcquireSpinLockAtDpcLevel( &cache->Lock );
+
+    if ((entry->Instance == Instance) &&
+        (entry->FileObject == FileObject)) {
+
+        context = (ContextType == FLT_STREAM_CONTEXT) ? entry->StreamContext :
+                                                        entry->FileContext;
+    }
+
+    if (context != NULL) {
+
+        FltReferenceContext( context );
+        cache->Hits++;
+
+    } else {
+
+        cache->Misses++;
+    }
+
+    KeReleaseSpinLockFromDpcLevel( &cache->Lock );
+    KeLowerIrql( oldIrql );
+
+    *Context = context;
+
+    return (context != NULL);
+}
+
+
+VOID
+CtxCacheContext (
+    _In_ PFLT_INSTANCE Instance,
+    _In_ PFILE_OBJECT FileObject,
+    _In_ FLT_CONTEXT_TYPE ContextType,
+    _In_ PFLT_CONTEXT Context
+    )
+/*++
+
+Routine Description:
+
+    This routine adds a stream or file context to the context cache of the
+    current processor, replacing what was cached in its slot.
+
+Arguments:
+
+    Instance              - Supplies the instance
+    FileObject            - Supplies the file object
+    ContextType           - Supplies FLT_STREAM_CONTEXT or FLT_FILE_CONTEXT
+    Context               - Supplies the context, the cache takes its own
+                            reference
+
+Return Value:
+
+    None
+
+--*/
+{
+    PCTX_CONTEXT_CACHE cache;
+    PCTX_CONTEXT_CACHE_ENTRY entry;
+    PFLT_CONTEXT *slot;
+    PFLT_CONTEXT evicted[3] = { NULL, NULL, NULL };
+    KIRQL oldIrql;
+    ULONG i;
+
+    FLT_ASSERT( (ContextType == FLT_STREAM_CONTEXT) || (ContextType == FLT_FILE_CONTEXT) );
+
+    if (!Globals.ContextCacheEnabled) {
+
+        return;
+    }
+
+    FltReferenceContext( Context );
+
+    KeRaiseIrql( DISPATCH_LEVEL, &oldIrql );
+
+    cache = &Globals.ContextCaches[KeGetCurrentProcessorNumberEx( NULL )];
+    entry = &cache->Entries[CtxContextCacheIndex( FileObject )];
+
+    KeAcquireSpinLockAtDpcLevel( &cache->Lock );
+
+    if ((entry->Instance != Instance) ||
+        (entry->FileObject != FileObject)) {
+
+        evicted[0] = entry->StreamContext;
+        evicted[1] = entry->FileContext;
+
+        entry->Instance = Instance;
+        entry->FileObject = FileObject;
+        entry->StreamContext = NULL;
+        entry->FileContext = NULL;
+    }
+
+    slot = (ContextType == FLT_STREAM_CONTEXT) ? &entry->StreamContext :
+                                                 &entry->FileContext;
+
+    evicted[2] = *slot;
+    *slot = Context;
+
+    KeReleaseSpinLockFromDpcLevel( &cache->Lock );
+    KeLowerIrql( oldIrql );
+
+    //
+    //  Release the references of the entry we replaced outside of the lock,
+    //  they may be the last ones.
+    //
+
+    for (i = 0; i < ARRAYSIZE( evicted ); i++) {
+
+        if (evicted[i] != NULL) {
+
+            FltReleaseContext( evicted[i] );
+        }
+    }
+}
+
+
+VOID
+CtxInvalidateCachedContexts (
+    _In_ PFLT_INSTANCE Instance,
+    _In_opt_ PFILE_OBJECT FileObject
+    )
+/*++
+
+Routine Description:
+
+    This routine drops the cached contexts of a file object, or of all file
+    objects of an instance, from the caches of all processors.
+
+Arguments:
+
+    Instance              - Supplies the instance
+    FileObject            - Supplies the file object, NULL for all
+
+Return Value:
+
+    None
+
+--*/
+{
+    PCTX_CONTEXT_CACHE cache;
+    PCTX_CONTEXT_CACHE_ENTRY entry;
+    PFLT_CONTEXT streamContext;
+    PFLT_CONTEXT fileContext;
+    KIRQL oldIrql;
+    ULONG first, last;
+    ULONG i, j;
+
+    if (!Globals.ContextCacheEnabled) {
+
+        return;
+    }
+
+    if (FileObject != NULL) {
+
+        first = CtxContextCacheIndex( FileObject );
+        last = first + 1;
+
+    } else {
+
+        first = 0;
+        last = CTX_CONTEXT_CACHE_SIZE;
+    }
+
+    for (i = 0; i < Globals.ContextCacheCount; i++) {
+
+        cache = &Globals.ContextCaches[i];
+
+        for (j = first; j < last; j++) {
+
+            entry = &cache->Entries[j];
+            streamContext = NULL;
+            fileContext = NULL;
+
+            KeAcquireSpinLock( &cache->Lock, &oldIrql );
+
+            if ((entry->Instance == Instance) &&
+                ((FileObject == NULL) || (entry->FileObject == FileObject))) {
+
+                streamContext = entry->StreamContext;
+                fileContext = entry->FileContext;
+
+                RtlZeroMemory( entry, sizeof( CTX_CONTEXT_CACHE_ENTRY ) );
+            }
+
+            KeReleaseSpinLock( &cache->Lock, oldIrql );
+
+            if (streamContext != NULL) {
+
+                FltReleaseContext( streamContext );
+            }
+
+            if (fileContext != NULL) {
+
+                FltReleaseContext( fileContext );
+            }
+        }
+    }
+}
+
@@ -631,6 +631,13 @@ CtxPreCloseCleanup:
         FltReleaseContext( streamContext );            
     }
 
+    //
+    //  This is the last operation on the file object, so drop the contexts
+    //  cached for it before the stream can be torn down.
+    //
+
+    CtxInvalidateCachedContexts( FltObjects->Instance, FltObjects->FileObject );
+
 
     DebugTrace( DEBUG_TRACE_ALL_IO,
                 ("[Ctx]: CtxPreClose -> Exit (Cbd = %p, FileObject = %p)\n",
@@ -39,9 +39,21 @@ Environment:
 #define DF_ERESOURCE_POOL_TAG           'sRfD'
 #define DF_DELETE_NOTIFY_POOL_TAG       'nDfD'
 #define DF_STRING_POOL_TAG              'rSfD'
+#define DF_DELETE_QUEUE_POOL_TAG        'qDfD'
 
 #define DF_CONTEXT_POOL_TYPE            PagedPool
 
+//
+//  Limits for the per-volume delete candidate queue.  The worker checks up
+//  to DF_DELETE_BATCH_SIZE candidates each time it takes the queue lock.
+//  Once DF_DELETE_QUEUE_MAX_DEPTH candidates are waiting, post-cleanup
+//  checks for deletion synchronously again, so a flood of deletes cannot
+//  grow the queue without bound.
+//
+
+#define DF_DELETE_BATCH_SIZE            32
+#define DF_DELETE_QUEUE_MAX_DEPTH       4096
+
 #define DF_NOTIFICATION_MASK            (TRANSACTION_NOTIFY_COMMIT_FINALIZE | \
                                          TRANSACTION_NOTIFY_ROLLBACK)
 
@@ -100,9 +112,114 @@ typedef union _DF_FILE_REFERENCE {
 //  Types                                                                   //
 //////////////////////////////////////////////////////////////////////////////
 
+//
+//  This is the per-volume queue of streams that have to be checked for
+//  deletion.  Post-cleanup inserts candidates here and a generic work item
+//  drains the queue in batches, so the thread that closed the last handle
+//  does not wait for the deletion check.
+//
+//  The queue is protected by a spin lock, so it is allocated from
+//  NonPagedPool and hangs off the (paged) instance context.
+//
+
+typedef struct _DF_DELETE_QUEUE {
+
+    //
+    //  Lock protecting CandidateList, Depth and WorkerActive.
+    //
+
+    KSPIN_LOCK Lock;
+
+    //
+    //  List of DF_DELETE_CANDIDATE structures waiting to be checked.
+    //
+
+    LIST_ENTRY CandidateList;
+
+    //
+    //  Current and highest number of candidates in CandidateList.
+    //
+
+    LONG Depth;
+
+    LONG MaxDepth;
+
+    //
+    //  Number of batches processed and number of candidates coalesced
+    //  because their stream was already queued.
+    //
+
+    volatile LONG Batches;
+
+    volatile LONG Coalesced;
+
+    //
+    //  The instance and volume this queue belongs to.
+    //
+
+    PFLT_INSTANCE Instance;
+
+    PFLT_VOLUME Volume;
+
+    //
+    //  Work item used to run DfDeleteQueueWorker.  It is queued whenever
+    //  WorkerActive goes from FALSE to TRUE.
+    //
+
+    PFLT_GENERIC_WORKITEM WorkItem;
+
+    //
+    //  TRUE while the worker owns the queue.
+    //
+
+    BOOLEAN WorkerActive;
+
+    //
+    //  Set at instance teardown; no more candidates are queued after this.
+    //
+
+    BOOLEAN ShuttingDown;
+
+    //
+    //  Signaled whenever the worker is not running.
+    //
+
+    KEVENT WorkerIdle;
+
+} DF_DELETE_QUEUE, *PDF_DELETE_QUEUE;
+
+
+//
+//  This structure represents a stream queued for a deletion check.
+//
+
+typedef struct _DF_DELETE_CANDIDATE {
+
+    //
+    //  Links to other DF_DELETE_CANDIDATE structures in the queue.
+    //
+
+    LIST_ENTRY Links;
+
+    //
+    //  Referenced file object that was cleaned up.  The file system keeps
+    //  answering queries on it until the last reference goes away.
+    //
+
+    PFILE_OBJECT FileObject;
+
+    //
+    //  Referenced stream context of the candidate stream.
+    //
+
+    struct _DF_STREAM_CONTEXT *StreamContext;
+
+} DF_DELETE_CANDIDATE, *PDF_DELETE_CANDIDATE;
+
+
 //
 //  This is the instance context for this minifilter, it stores the volume's
-//  GUID name.
+//  GUID name and the delete candidate queue.
 //
 
 typedef struct _DF_INSTANCE_CONTEXT {
@@ -113,6 +230,13 @@ typedef struct _DF_INSTANCE_CONTEXT {
 
     UNICODE_STRING VolumeGuidName;
 
+    //
+    //  Delete candidate queue.  This is NULL if the instance context was
+    //  created without one, in which case deletes are checked synchronously.
+    //
+
+    PDF_DELETE_QUEUE DeleteQueue;
+
 } DF_INSTANCE_CONTEXT, *PDF_INSTANCE_CONTEXT;
 
 
@@ -156,6 +280,13 @@ typedef struct _DF_STREAM_CONTEXT {
 
     volatile LONG               IsNotified;
 
+    //
+    //  IsQueued == 1 means the stream is waiting in the delete queue, so a
+    //  further cleanup does not need to queue it again.
+    //
+
+    volatile LONG               IsQueued;
+
     //
     //  Whether or not we've already queried the file ID.
     //
@@ -351,7 +482,6 @@ DfFreeUnicodeString (
 
 NTSTATUS
 DfBuildFileIdString (
-    _In_ PFLT_CALLBACK_DATA Data,
     _In_ PCFLT_RELATED_OBJECTS FltObjects,
     _In_ PDF_STREAM_CONTEXT StreamContext,
     _Out_ PUNICODE_STRING String
@@ -359,14 +489,12 @@ DfBuildFileIdString (
 
 NTSTATUS
 DfDetectDeleteByFileId (
-    _In_ PFLT_CALLBACK_DATA Data,
     _In_ PCFLT_RELATED_OBJECTS FltObjects,
     _In_ PDF_STREAM_CONTEXT StreamContext
     );
 
 NTSTATUS
 DfIsFileDeleted (
-    _In_ PFLT_CALLBACK_DATA Data,
     _In_ PCFLT_RELATED_OBJECTS FltObjects,
     _In_ PDF_STREAM_CONTEXT StreamContext,
     _In_ BOOLEAN IsTransaction
@@ -394,11 +522,39 @@ DfNotifyDeleteOnTransactionEnd (
 
 NTSTATUS
 DfProcessDelete (
-    _Inout_ PFLT_CALLBACK_DATA Data,
     _In_ PCFLT_RELATED_OBJECTS FltObjects,
     _In_ PDF_STREAM_CONTEXT    StreamContext
     );
 
+NTSTATUS
+DfQueueDeleteCandidate (
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ PDF_STREAM_CONTEXT StreamContext
+    );
+
+VOID
+DfProcessDeleteQueue (
+    _Inout_ PDF_DELETE_QUEUE DeleteQueue
+    );
+
+VOID
+DfShutdownDeleteQueue (
+    _Inout_ PDF_DELETE_QUEUE DeleteQueue
+    );
+
+VOID
+DfCheckDeleteCandidate (
+    _In_ PDF_DELETE_QUEUE DeleteQueue,
+    _In_ PDF_DELETE_CANDIDATE Candidate
+    );
+
+VOID
+DfDeleteQueueWorker (
+    _In_ PFLT_GENERIC_WORKITEM FltWorkItem,
+    _In_ PVOID FltObject,
+    _In_opt_ PVOID Context
+    );
+
 FLT_PREOP_CALLBACK_STATUS
 DfPreCreateCallback (
     _Inout_ PFLT_CALLBACK_DATA Data,
@@ -459,7 +615,7 @@ DfGetVolumeGuidName (
 
 NTSTATUS
 DfGetFileId (
-    _In_  PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
     _Inout_ PDF_STREAM_CONTEXT StreamContext
     );
 
@@ -493,6 +649,8 @@ DfGetFileId (
 #pragma alloc_text(PAGE, DfNotifyDelete)
 #pragma alloc_text(PAGE, DfNotifyDeleteOnTransactionEnd)
 #pragma alloc_text(PAGE, DfProcessDelete)
+#pragma alloc_text(PAGE, DfCheckDeleteCandidate)
+#pragma alloc_text(PAGE, DfDeleteQueueWorker)
 #pragma alloc_text(PAGE, DfPreCreateCallback)
 #pragma alloc_text(PAGE, DfPostCreateCallback)
 #pragma alloc_text(PAGE, DfPreSetInfoCallback)
@@ -784,6 +942,24 @@ Return Value:
         return STATUS_FLT_DO_NOT_ATTACH;
     }
 
+    //
+    //  Set up the instance context with the delete candidate queue.  If this
+    //  fails we still attach; deletes on this volume will just be checked
+    //  synchronously in post-cleanup.
+    //
+
+    status = DfSetupInstanceContext( FltObjects );
+
+    if (!NT_SUCCESS( status )) {
+
+        DF_DBG_PRINT( DFDBG_TRACE_ERRORS,
+                      "delete!%s: Failed to set up the instance context (0x%08x)!\n",
+                      __FUNCTION__,
+                      status );
+
+        status = STATUS_SUCCESS;
+    }
+
     return status;
 }
  
@@ -850,13 +1026,33 @@ Return Value:
 
 --*/
 {
-    UNREFERENCED_PARAMETER( FltObjects );
+    NTSTATUS status;
+    PDF_INSTANCE_CONTEXT instanceContext;
+
     UNREFERENCED_PARAMETER( Flags );
 
     PAGED_CODE();
 
     DF_DBG_PRINT( DFDBG_TRACE_ROUTINES,
                   "delete!DfInstanceTeardownStart: Entered\n" );
+
+    //
+    //  Stop queueing delete candidates and wait for the worker to finish
+    //  the ones already queued, since it uses this instance.
+    //
+
+    status = FltGetInstanceContext( FltObjects->Instance,
+                                    &instanceContext );
+
+    if (NT_SUCCESS( status )) {
+
+        if (NULL != instanceContext->DeleteQueue) {
+
+            DfShutdownDeleteQueue( instanceContext->DeleteQueue );
+        }
+
+        FltReleaseContext( instanceContext );
+    }
 }
 
 
@@ -894,6 +1090,89 @@ Return Value:
 }
 
 
+NTSTATUS
+DfSetupInstanceContext (
+    _In_ PCFLT_RELATED_OBJECTS FltObjects
+    )
+/*++
+
+Routine Description:
+
+    This routine creates the instance context, along with its delete
+    candidate queue, and attaches it to the instance.
+
+Arguments:
+
+    FltObjects - Pointer to the FLT_RELATED_OBJECTS data structure containing
+        opaque handles to this filter, instance and its associated volume.
+
+Return Value:
+
+    STATUS_INSUFFICIENT_RESOURCES if the queue could not be allocated.
+    Otherwise a status forwarded from DfAllocateContext or DfSetContext.
+
+--*/
+{
+    NTSTATUS status;
+    PDF_INSTANCE_CONTEXT instanceContext = NULL;
+    PDF_DELETE_QUEUE deleteQueue;
+
+    PAGED_CODE();
+
+    deleteQueue = ExAllocatePoolWithTag( NonPagedPool,
+                                         sizeof(DF_DELETE_QUEUE),
+                                         DF_DELETE_QUEUE_POOL_TAG );
+
+    if (NULL == deleteQueue) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory( deleteQueue, sizeof(DF_DELETE_QUEUE) );
+
+    deleteQueue->WorkItem = FltAllocateGenericWorkItem();
+
+    if (NULL == deleteQueue->WorkItem) {
+
+        ExFreePoolWithTag( deleteQueue, DF_DELETE_QUEUE_POOL_TAG );
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    KeInitializeSpinLock( &deleteQueue->Lock );
+    InitializeListHead( &deleteQueue->CandidateList );
+    KeInitializeEvent( &deleteQueue->WorkerIdle, NotificationEvent, TRUE );
+    deleteQueue->Instance = FltObjects->Instance;
+    deleteQueue->Volume = FltObjects->Volume;
+
+    status = DfAllocateContext( FLT_INSTANCE_CONTEXT,
+                                &instanceContext );
+
+    if (!NT_SUCCESS( status )) {
+
+        FltFreeGenericWorkItem( deleteQueue->WorkItem );
+        ExFreePoolWithTag( deleteQueue, DF_DELETE_QUEUE_POOL_TAG );
+        return status;
+    }
+
+    //
+    //  From here on the queue is freed by the instance context cleanup
+    //  callback.
+    //
+
+    instanceContext->DeleteQueue = deleteQueue;
+
+    status = DfSetContext( FltObjects,
+                           NULL,
+                           FLT_INSTANCE_CONTEXT,
+                           instanceContext,
+                           NULL );
+
+    FltReleaseContext( instanceContext );
+
+    return status;
+}
+
+
 //////////////////////////////////////////////////////////////////////////////
 //  Context manipulation functions                                          //
 //////////////////////////////////////////////////////////////////////////////
@@ -1443,7 +1722,7 @@ DfInstanceContextCleanupCallback (
 Routine Description:
 
     This routine cleans up an instance context, which consists on freeing
-    pool used by the volume GUID name string.
+    pool used by the volume GUID name string and the delete queue.
 
 Arguments:
 
@@ -1460,6 +1739,15 @@ Arguments:
     ASSERT( ContextType == FLT_INSTANCE_CONTEXT );
 
     DfFreeUnicodeString( &InstanceContext->VolumeGuidName );
+
+    if (NULL != InstanceContext->DeleteQueue) {
+
+        ASSERT( IsListEmpty( &InstanceContext->DeleteQueue->CandidateList ) );
+
+        FltFreeGenericWorkItem( InstanceContext->DeleteQueue->WorkItem );
+        ExFreePoolWithTag( InstanceContext->DeleteQueue, DF_DELETE_QUEUE_POOL_TAG );
+        InstanceContext->DeleteQueue = NULL;
+    }
 }
 
 
@@ -1542,7 +1830,7 @@ Return Value:
 
 NTSTATUS
 DfGetFileId (
-    _In_  PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
     _Inout_ PDF_STREAM_CONTEXT StreamContext
     )
 /*++
@@ -1553,7 +1841,9 @@ Routine Description:
 
 Arguments:
 
-    Data  - Pointer to FLT_CALLBACK_DATA.
+    FltObjects - Pointer to the FLT_RELATED_OBJECTS data structure containing
+        opaque handles to this filter, instance, its associated volume and
+        file object.
 
     StreamContext - Pointer to stream context that will receive the file
                     ID.
@@ -1582,8 +1872,8 @@ Return Value:
         //  Querying for FileInternalInformation gives you the file ID.
         //
 
-        status = FltQueryInformationFile( Data->Iopb->TargetInstance,
-                                          Data->Iopb->TargetFileObject,
+        status = FltQueryInformationFile( FltObjects->Instance,
+                                          FltObjects->FileObject,
                                           &fileInternalInformation,
                                           sizeof(FILE_INTERNAL_INFORMATION),
                                           FileInternalInformation,
@@ -1602,8 +1892,8 @@ Return Value:
 
                 FILE_ID_INFORMATION fileIdInformation;
 
-                status = FltQueryInformationFile( Data->Iopb->TargetInstance,
-                                                  Data->Iopb->TargetFileObject,
+                status = FltQueryInformationFile( FltObjects->Instance,
+                                                  FltObjects->FileObject,
                                                   &fileIdInformation,
                                                   sizeof(FILE_ID_INFORMATION),
                                                   FileIdInformation,
@@ -1904,7 +2194,6 @@ Return Value:
 
 NTSTATUS
 DfBuildFileIdString (
-    _In_ PFLT_CALLBACK_DATA Data,
     _In_ PCFLT_RELATED_OBJECTS FltObjects,
     _In_ PDF_STREAM_CONTEXT StreamContext,
     _Out_ PUNICODE_STRING String
@@ -1920,8 +2209,6 @@ Routine Description:
 
 Arguments:
 
-    Data - Pointer to FLT_CALLBACK_DATA.
-
     FltObjects - Pointer to the FLT_RELATED_OBJECTS data structure containing
         opaque handles to this filter, instance, its associated volume and
         file object.
@@ -1959,7 +2246,7 @@ Return Value:
     //  may get either a 64-bit or 128-bit file ID back.
     //
 
-    status = DfGetFileId( Data,
+    status = DfGetFileId( FltObjects,
                           StreamContext );
 
     if (!NT_SUCCESS( status )) {
@@ -2017,7 +2304,6 @@ Return Value:
 
 NTSTATUS
 DfDetectDeleteByFileId (
-    _In_ PFLT_CALLBACK_DATA Data,
     _In_ PCFLT_RELATED_OBJECTS FltObjects,
     _In_ PDF_STREAM_CONTEXT StreamContext
     )
@@ -2032,8 +2318,6 @@ Routine Description:
 
 Arguments:
 
-    Data - Pointer to FLT_CALLBACK_DATA.
-
     FltObjects - Pointer to the FLT_RELATED_OBJECTS data structure containing
         opaque handles to this filter, instance, its associated volume and
         file object.
@@ -2071,8 +2355,7 @@ Return Value:
     //  the file is deleted, that's perfectly okay.
     //
 
-    status = DfBuildFileIdString( Data,
-                                  FltObjects,
+    status = DfBuildFileIdString( FltObjects,
                                   StreamContext,
                                   &fileIdString );
 
@@ -2096,10 +2379,10 @@ Return Value:
 
     IoInitializeDriverCreateContext( &driverCreateContext );
     driverCreateContext.TxnParameters =
-        IoGetTransactionParameterBlock( Data->Iopb->TargetFileObject );
+        IoGetTransactionParameterBlock( FltObjects->FileObject );
 
     status = FltCreateFileEx2( gFilterHandle,
-                               Data->Iopb->TargetInstance,
+                               FltObjects->Instance,
                                &handle,
                                NULL,
                                FILE_READ_ATTRIBUTES,
@@ -2133,7 +2416,6 @@ Return Value:
 
 NTSTATUS
 DfIsFileDeleted (
-    _In_ PFLT_CALLBACK_DATA Data,
     _In_ PCFLT_RELATED_OBJECTS FltObjects,
     _In_ PDF_STREAM_CONTEXT StreamContext,
     _In_ BOOLEAN IsTransaction
@@ -2151,8 +2433,6 @@ Routine Description:
 
 Arguments:
 
-    Data - Pointer to the filter callbackData that is passed to us.
-
     FltObjects - Pointer to the FLT_RELATED_OBJECTS data structure containing
         opaque handles to this filter, instance, its associated volume and
         file object.
@@ -2201,8 +2481,7 @@ Return Value:
     if (IsTransaction ||
         (fileSystemType == FLT_FSTYPE_REFS)) {
 
-        status = DfDetectDeleteByFileId( Data,
-                                         FltObjects,
+        status = DfDetectDeleteByFileId( FltObjects,
                                          StreamContext );
 
         switch (status) {
@@ -2239,8 +2518,8 @@ Return Value:
         //  file is a cheaper alternative compared to opening the file by ID.
         //
 
-        status = FltFsControlFile( Data->Iopb->TargetInstance,
-                                   Data->Iopb->TargetFileObject,
+        status = FltFsControlFile( FltObjects->Instance,
+                                   FltObjects->FileObject,
                                    FSCTL_GET_OBJECT_ID,
                                    NULL,
                                    0,
@@ -2465,7 +2744,6 @@ Arguments:
 
 NTSTATUS
 DfProcessDelete (
-    _Inout_ PFLT_CALLBACK_DATA Data,
     _In_ PCFLT_RELATED_OBJECTS FltObjects,
     _In_ PDF_STREAM_CONTEXT    StreamContext
     )
@@ -2474,14 +2752,12 @@ DfProcessDelete (
 Routine Description:
 
     This routine does the processing after it is verified, in the post-cleanup
-    callback, that a file or stream were deleted. It sorts out whether it's a
-    file or a stream delete, whether this is in a transacted context or not,
-    and issues the appropriate notifications.
+    callback or the delete queue worker, that a file or stream were deleted.
+    It sorts out whether it's a file or a stream delete, whether this is in a
+    transacted context or not, and issues the appropriate notifications.
 
 Arguments:
 
-    Data - Pointer to the filter callbackData that is passed to us.
-
     FltObjects - Pointer to the FLT_RELATED_OBJECTS data structure containing
         opaque handles to this filter, instance, its associated volume and
         file object.
@@ -2525,8 +2801,7 @@ Return Value:
     //  this could be the last handle to a delete-pending file.
     //
 
-    status = DfIsFileDeleted( Data,
-                              FltObjects,
+    status = DfIsFileDeleted( FltObjects,
                               StreamContext,
                               isTransaction );
 
@@ -2560,6 +2835,425 @@ _exit:
 }
 
 
+//////////////////////////////////////////////////////////////////////////////
+//  Delete Candidate Queue Functions                                        //
+//////////////////////////////////////////////////////////////////////////////
+
+NTSTATUS
+DfQueueDeleteCandidate (
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ PDF_STREAM_CONTEXT StreamContext
+    )
+/*++
+
+Routine Description:
+
+    This routine queues a stream that was flagged as a deletion candidate so
+    that the volume's delete queue worker checks it for deletion, instead of
+    post-cleanup doing it synchronously.
+
+    If the stream is already waiting in the queue, the new candidate is
+    coalesced with the queued one.  The check happens after this cleanup
+    either way.
+
+    This routine takes a spin lock so it is not pageable, but it must be
+    called at PASSIVE_LEVEL.
+
+Arguments:
+
+    FltObjects - Pointer to the FLT_RELATED_OBJECTS data structure containing
+        opaque handles to this filter, instance, its associated volume and
+        file object.
+
+    StreamContext - Pointer to the stream context of the candidate stream.
+
+Return Value:
+
+    STATUS_SUCCESS - The candidate was queued or coalesced.
+
+    STATUS_FLT_DELETING_OBJECT - The instance is being torn down.
+
+    STATUS_INSUFFICIENT_RESOURCES - The queue is full or an allocation failed.
+
+    Also any status forwarded from FltGetInstanceContext.  On failure the
+    caller has to check for deletion itself.
+
+--*/
+{
+    NTSTATUS status;
+    PDF_INSTANCE_CONTEXT instanceContext = NULL;
+    PDF_DELETE_QUEUE deleteQueue;
+    PDF_DELETE_CANDIDATE candidate = NULL;
+    BOOLEAN startWorker = FALSE;
+    KIRQL oldIrql;
+
+    status = FltGetInstanceContext( FltObjects->Instance,
+                                    &instanceContext );
+
+    if (!NT_SUCCESS( status )) {
+
+        return status;
+    }
+
+    deleteQueue = instanceContext->DeleteQueue;
+
+    if (NULL == deleteQueue) {
+
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto _exit;
+    }
+
+    //
+    //  If this stream is already queued, there is nothing else to do.  The
+    //  worker clears IsQueued before checking the stream, so the queued
+    //  check is guaranteed to happen after this cleanup.
+    //
+
+    if (0 != InterlockedCompareExchange( &StreamContext->IsQueued, 1, 0 )) {
+
+        InterlockedIncrement( &deleteQueue->Coalesced );
+        status = STATUS_SUCCESS;
+        goto _exit;
+    }
+
+    candidate = ExAllocatePoolWithTag( NonPagedPool,
+                                       sizeof(DF_DELETE_CANDIDATE),
+                                       DF_DELETE_QUEUE_POOL_TAG );
+
+    if (NULL == candidate) {
+
+        InterlockedExchange( &StreamContext->IsQueued, 0 );
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto _exit;
+    }
+
+    //
+    //  Keep the file object alive so the worker can still query the file
+    //  system through it after this cleanup returns.
+    //
+
+    ObReferenceObject( FltObjects->FileObject );
+    FltReferenceContext( StreamContext );
+
+    candidate->FileObject = FltObjects->FileObject;
+    candidate->StreamContext = StreamContext;
+
+    KeAcquireSpinLock( &deleteQueue->Lock, &oldIrql );
+
+    if (deleteQueue->ShuttingDown) {
+
+        status = STATUS_FLT_DELETING_OBJECT;
+
+    } else if (deleteQueue->Depth >= DF_DELETE_QUEUE_MAX_DEPTH) {
+
+        status = STATUS_INSUFFICIENT_RESOURCES;
+
+    } else {
+
+        InsertTailList( &deleteQueue->CandidateList,
+                        &candidate->Links );
+
+        deleteQueue->Depth++;
+
+        if (deleteQueue->Depth > deleteQueue->MaxDepth) {
+
+            deleteQueue->MaxDepth = deleteQueue->Depth;
+        }
+
+        if (!deleteQueue->WorkerActive) {
+
+            deleteQueue->WorkerActive = TRUE;
+            KeClearEvent( &deleteQueue->WorkerIdle );
+            startWorker = TRUE;
+        }
+
+        candidate = NULL;
+    }
+
+    KeReleaseSpinLock( &deleteQueue->Lock, oldIrql );
+
+    if (NULL != candidate) {
+
+        //
+        //  The candidate was not queued, undo everything.
+        //
+
+        InterlockedExchange( &StreamContext->IsQueued, 0 );
+        FltReleaseContext( StreamContext );
+        ObDereferenceObject( candidate->FileObject );
+        ExFreePoolWithTag( candidate, DF_DELETE_QUEUE_POOL_TAG );
+        goto _exit;
+    }
+
+    if (startWorker) {
+
+        status = FltQueueGenericWorkItem( deleteQueue->WorkItem,
+                                          FltObjects->Instance,
+                                          DfDeleteQueueWorker,
+                                          DelayedWorkQueue,
+                                          deleteQueue );
+
+        if (!NT_SUCCESS( status )) {
+
+            //
+            //  We own the queue but there is no worker to drain it, so
+            //  drain it on this thread.  The candidate has been handled
+            //  either way.
+            //
+
+            DfProcessDeleteQueue( deleteQueue );
+        }
+    }
+
+    status = STATUS_SUCCESS;
+
+_exit:
+
+    FltReleaseContext( instanceContext );
+
+    return status;
+}
+
+
+VOID
+DfProcessDeleteQueue (
+    _Inout_ PDF_DELETE_QUEUE DeleteQueue
+    )
+/*++
+
+Routine Description:
+
+    This routine drains the delete candidate queue.  Candidates are taken
+    off the queue in batches of up to DF_DELETE_BATCH_SIZE, so that the
+    queue lock is taken once per batch rather than once per candidate.
+
+    Only the thread that set WorkerActive calls this routine.  It clears
+    WorkerActive and signals WorkerIdle once the queue is empty.
+
+    This routine takes a spin lock so it is not pageable, but it must be
+    called at PASSIVE_LEVEL.
+
+Arguments:
+
+    DeleteQueue - Pointer to the delete candidate queue.
+
+--*/
+{
+    LIST_ENTRY batch;
+    PDF_DELETE_CANDIDATE candidate;
+    ULONG batchCount;
+    LONG depth;
+    KIRQL oldIrql;
+
+    for (;;) {
+
+        InitializeListHead( &batch );
+        batchCount = 0;
+
+        KeAcquireSpinLock( &DeleteQueue->Lock, &oldIrql );
+
+        while ((batchCount < DF_DELETE_BATCH_SIZE) &&
+               !IsListEmpty( &DeleteQueue->CandidateList )) {
+
+            InsertTailList( &batch,
+                            RemoveHeadList( &DeleteQueue->CandidateList ) );
+            batchCount++;
+        }
+
+        DeleteQueue->Depth -= batchCount;
+        depth = DeleteQueue->Depth;
+
+        if (0 == batchCount) {
+
+            DeleteQueue->WorkerActive = FALSE;
+            KeSetEvent( &DeleteQueue->WorkerIdle, IO_NO_INCREMENT, FALSE );
+        }
+
+        KeReleaseSpinLock( &DeleteQueue->Lock, oldIrql );
+
+        if (0 == batchCount) {
+
+            break;
+        }
+
+        while (!IsListEmpty( &batch )) {
+
+            candidate = CONTAINING_RECORD( RemoveHeadList( &batch ),
+                                           DF_DELETE_CANDIDATE,
+                                           Links );
+
+            DfCheckDeleteCandidate( DeleteQueue, candidate );
+        }
+
+        InterlockedIncrement( &DeleteQueue->Batches );
+
+        DF_DBG_PRINT( DFDBG_TRACE_OPERATION_STATUS,
+                      "delete!%s: Checked a batch of %lu candidates, %ld still queued.\n",
+                      __FUNCTION__,
+                      batchCount,
+                      depth );
+    }
+}
+
+
+VOID
+DfCheckDeleteCandidate (
+    _In_ PDF_DELETE_QUEUE DeleteQueue,
+    _In_ PDF_DELETE_CANDIDATE Candidate
+    )
+/*++
+
+Routine Description:
+
+    This routine checks a single queued candidate for deletion, notifies the
+    deletion if there was one, and frees the candidate.
+
+Arguments:
+
+    DeleteQueue - Pointer to the delete candidate queue the candidate was
+        taken from.
+
+    Candidate - Pointer to the candidate; freed by this routine.
+
+--*/
+{
+    FILE_STANDARD_INFORMATION fileInfo;
+    PDF_STREAM_CONTEXT streamContext = Candidate->StreamContext;
+    NTSTATUS status;
+
+    //
+    //  Transacted cleanups are never queued, so this is built without a
+    //  transaction.
+    //
+
+#pragma warning(push)
+#pragma warning(disable:4204) // C4204 nonstandard extension used : non-constant aggregate initializer
+    FLT_RELATED_OBJECTS fltObjects = { sizeof(FLT_RELATED_OBJECTS),
+                                       0,
+                                       gFilterHandle,
+                                       DeleteQueue->Volume,
+                                       DeleteQueue->Instance,
+                                       Candidate->FileObject,
+                                       NULL };
+#pragma warning(pop)
+
+    PAGED_CODE();
+
+    //
+    //  From here on a new cleanup on this stream has to queue it again.
+    //
+
+    InterlockedExchange( &streamContext->IsQueued, 0 );
+
+    if (0 == streamContext->IsNotified) {
+
+        status = FltQueryInformationFile( DeleteQueue->Instance,
+                                          Candidate->FileObject,
+                                          &fileInfo,
+                                          sizeof(fileInfo),
+                                          FileStandardInformation,
+                                          NULL );
+
+        if (STATUS_FILE_DELETED == status) {
+
+            status = DfProcessDelete( &fltObjects,
+                                      streamContext );
+
+            if (!NT_SUCCESS( status )) {
+
+                DF_DBG_PRINT( DFDBG_TRACE_ERRORS,
+                              "delete!%s: It was not possible to verify "
+                              "deletion due to an error in DfProcessDelete (0x%08x)!\n",
+                              __FUNCTION__,
+                              status );
+            }
+        }
+    }
+
+    FltReleaseContext( streamContext );
+    ObDereferenceObject( Candidate->FileObject );
+    ExFreePoolWithTag( Candidate, DF_DELETE_QUEUE_POOL_TAG );
+}
+
+
+VOID
+DfDeleteQueueWorker (
+    _In_ PFLT_GENERIC_WORKITEM FltWorkItem,
+    _In_ PVOID FltObject,
+    _In_opt_ PVOID Context
+    )
+/*++
+
+Routine Description:
+
+    This is the generic work item routine that drains a volume's delete
+    candidate queue.
+
+Arguments:
+
+    FltWorkItem - The generic work item; owned by the queue and reused.
+
+    FltObject - The instance the queue belongs to.
+
+    Context - Pointer to the delete candidate queue.
+
+--*/
+{
+    UNREFERENCED_PARAMETER( FltWorkItem );
+    UNREFERENCED_PARAMETER( FltObject );
+
+    PAGED_CODE();
+
+    ASSERT( NULL != Context );
+
+    DfProcessDeleteQueue( (PDF_DELETE_QUEUE) Context );
+}
+
+
+VOID
+DfShutdownDeleteQueue (
+    _Inout_ PDF_DELETE_QUEUE DeleteQueue
+    )
+/*++
+
+Routine Description:
+
+    This routine stops new candidates from being queued and waits for the
+    worker to drain the candidates already queued.  It is called at
+    instance teardown.
+
+    This routine takes a spin lock so it is not pageable, but it must be
+    called at PASSIVE_LEVEL.
+
+Arguments:
+
+    DeleteQueue - Pointer to the delete candidate queue.
+
+--*/
+{
+    KIRQL oldIrql;
+
+    KeAcquireSpinLock( &DeleteQueue->Lock, &oldIrql );
+    DeleteQueue->ShuttingDown = TRUE;
+    KeReleaseSpinLock( &DeleteQueue->Lock, oldIrql );
+
+    KeWaitForSingleObject( &DeleteQueue->WorkerIdle,
+                           Executive,
+                           KernelMode,
+                           FALSE,
+                           NULL );
+
+    DF_DBG_PRINT( DFDBG_TRACE_OPERATION_STATUS,
+                  "delete!%s: Delete queue %p processed %ld batches, "
+                  "coalesced %ld candidates, max depth %ld.\n",
+                  __FUNCTION__,
+                  DeleteQueue,
+                  DeleteQueue->Batches,
+                  DeleteQueue->Coalesced,
+                  DeleteQueue->MaxDepth );
+}
+
+
 //////////////////////////////////////////////////////////////////////////////
 //  MiniFilter Operation Callback Routines                                  //
 //////////////////////////////////////////////////////////////////////////////
@@ -3055,6 +3749,8 @@ Routine Description:
 
     Post-cleanup is the core of this minifilter. Here we check to see if
     the stream or file were deleted and report that through DbgPrint.
+    Candidates outside of a transaction are queued to the volume's delete
+    queue and checked by its worker instead.
 
 Arguments:
 
@@ -3122,6 +3818,28 @@ Return Value:
              (streamContext->DeleteOnClose)) &&
             (0 == streamContext->IsNotified)) {
 
+            //
+            //  Outside of a transaction, hand the candidate to the volume's
+            //  delete queue so this thread does not wait for the check.
+            //  Transacted deletes are checked right here, because the
+            //  notification has to be attached to the transaction context
+            //  before the transaction can commit or roll back.
+            //
+            //  If the candidate cannot be queued, fall back to checking it
+            //  synchronously.
+            //
+
+            if (NULL == FltObjects->Transaction) {
+
+                status = DfQueueDeleteCandidate( FltObjects,
+                                                 streamContext );
+
+                if (NT_SUCCESS( status )) {
+
+                    goto _exit;
+                }
+            }
+
             //
             //  The check for deletion is done via a query to
             //  FileStandardInformation. If that returns STATUS_FILE_DELETED
@@ -3137,8 +3855,7 @@ Return Value:
 
             if (STATUS_FILE_DELETED == status) {
 
-                status = DfProcessDelete( Data,
-                                          FltObjects,
+                status = DfProcessDelete( FltObjects,
                                           streamContext );
 
                 if (!NT_SUCCESS( status )) {
@@ -3153,6 +3870,8 @@ Return Value:
         }
     }
 
+_exit:
+
     FltReleaseContext( streamContext );
 
     return FLT_POSTOP_FINISHED_PROCESSING;
@@ -0,0 +1,601 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+Module Name:
+
+    fltBench.c
+
+Abstract:
+
+    This is a user mode benchmark that measures what a minifilter costs.
+    It runs storms of create, read, write and directory query operations
+    against a directory, first with the filter attached to the volume of
+    that directory and then with the filter detached, and reports the time
+    the filter adds to each operation.
+
+    Reads and writes are short cached transfers, so the time measured is
+    dominated by the I/O path and any filter overhead, not by the disk.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <windows.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fltuser.h>
+#include <dontuse.h>
+
+//
+//  Defaults for the command line parameters, and the shape of the storms.
+//
+
+#define FLTBENCH_DEFAULT_ITERATIONS         10000
+#define FLTBENCH_DEFAULT_PASSES             5
+#define FLTBENCH_FILE_COUNT                 64
+#define FLTBENCH_TRANSFER_SIZE              4096
+#define FLTBENCH_WORK_DIRECTORY             L"fltBench.tmp"
+#define FLTBENCH_INSTANCE_NAME_SIZE         (INSTANCE_NAME_MAX_CHARS + 1)
+
+typedef enum _FLTBENCH_OPERATION {
+
+    BenchCreate,
+    BenchRead,
+    BenchWrite,
+    BenchQueryDirectory,
+    BenchOperationCount
+
+} FLTBENCH_OPERATION;
+
+const PCSTR OperationNames[BenchOperationCount] = {
+
+    "create",
+    "read",
+    "write",
+    "query directory"
+};
+
+//
+//  State shared by the storms.
+//
+
+typedef struct _FLTBENCH_CONTEXT {
+
+    //
+    //  The directory the storms run in and a file in it that the create,
+    //  read and write storms use.
+    //
+
+    WCHAR Directory[MAX_PATH];
+    WCHAR SearchPattern[MAX_PATH];
+    WCHAR FileName[MAX_PATH];
+
+    ULONG Iterations;
+    ULONG Passes;
+
+    LARGE_INTEGER Frequency;
+
+    UCHAR Buffer[FLTBENCH_TRANSFER_SIZE];
+
+} FLTBENCH_CONTEXT, *PFLTBENCH_CONTEXT;
+
+
+VOID
+Usage (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Prints usage
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+{
+    printf( "Measures the time a minifilter adds to file system operations\n" );
+    printf( "Usage: fltBench <filter name> <directory> [iterations] [passes]\n" );
+    printf( "    The filter must be loaded. It is attached to and detached from\n" );
+    printf( "    the volume of the directory and left as it was found.\n" );
+    printf( "    Defaults: %u iterations, %u passes\n",
+            FLTBENCH_DEFAULT_ITERATIONS,
+            FLTBENCH_DEFAULT_PASSES );
+}
+
+
+BOOL
+PrepareFiles (
+    _In_ PFLTBENCH_CONTEXT Context
+    )
+/*++
+
+Routine Description:
+
+    This creates the work directory and fills it with the files the storms
+    operate on.
+
+Arguments:
+
+    Context - The benchmark context.
+
+Return Value:
+
+    TRUE if the files were created.
+
+--*/
+{
+    WCHAR fileName[MAX_PATH];
+    HANDLE file;
+    DWORD bytesWritten;
+    ULONG index;
+
+    if (!CreateDirectoryW( Context->Directory, NULL ) &&
+        (GetLastError() != ERROR_ALREADY_EXISTS)) {
+
+        printf( "ERROR: Could not create %S: %d\n", Context->Directory, GetLastError() );
+        return FALSE;
+    }
+
+    memset( Context->Buffer, 'b', sizeof( Context->Buffer ) );
+
+    for (index = 0; index < FLTBENCH_FILE_COUNT; index++) {
+
+        swprintf_s( fileName, MAX_PATH, L"%s\\file%03d.dat", Context->Directory, index );
+
+        file = CreateFileW( fileName,
+                            GENERIC_WRITE,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                            NULL,
+                            CREATE_ALWAYS,
+                            FILE_ATTRIBUTE_NORMAL,
+                            NULL );
+
+        if (file == INVALID_HANDLE_VALUE) {
+
+            printf( "ERROR: Could not create %S: %d\n", fileName, GetLastError() );
+            return FALSE;
+        }
+
+        if (!WriteFile( file, Context->Buffer, sizeof( Context->Buffer ), &bytesWritten, NULL )) {
+
+            printf( "ERROR: Could not write %S: %d\n", fileName, GetLastError() );
+            CloseHandle( file );
+            return FALSE;
+        }
+
+        CloseHandle( file );
+    }
+
+    return TRUE;
+}
+
+
+VOID
+CleanupFiles (
+    _In_ PFLTBENCH_CONTEXT Context
+    )
+/*++
+
+Routine Description:
+
+    This deletes the files the storms operated on and the work directory.
+
+Arguments:
+
+    Context - The benchmark context.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    WCHAR fileName[MAX_PATH];
+    ULONG index;
+
+    for (index = 0; index < FLTBENCH_FILE_COUNT; index++) {
+
+        swprintf_s( fileName, MAX_PATH, L"%s\\file%03d.dat", Context->Directory, index );
+        DeleteFileW( fileName );
+    }
+
+    RemoveDirectoryW( Context->Directory );
+}
+
+
+BOOL
+RunStorm (
+    _In_ PFLTBENCH_CONTEXT Context,
+    _In_ FLTBENCH_OPERATION Operation,
+    _Out_ PLONGLONG Ticks
+    )
+/*++
+
+Routine Description:
+
+    This runs one storm of the given operation and measures how long it
+    takes.
+
+Arguments:
+
+    Context - The benchmark context.
+
+    Operation - The operation to repeat.
+
+    Ticks - Receives the performance counter ticks the storm took.
+
+Return Value:
+
+    TRUE if every operation of the storm succeeded.
+
+--*/
+{
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    HANDLE file = INVALID_HANDLE_VALUE;
+    WIN32_FIND_DATAW findData;
+    HANDLE find;
+    OVERLAPPED overlapped;
+    DWORD bytesTransferred;
+    BOOL result = TRUE;
+    ULONG index;
+
+    *Ticks = 0;
+
+    //
+    //  Reads and writes go to an open handle so that only the transfer is
+    //  measured. The same offset is used every time so the data stays in
+    //  the cache.
+    //
+
+    if ((Operation == BenchRead) || (Operation == BenchWrite)) {
+
+        file = CreateFileW( Context->FileName,
+                            GENERIC_READ | GENERIC_WRITE,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                            NULL,
+                            OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL,
+                            NULL );
+
+        if (file == INVALID_HANDLE_VALUE) {
+
+            printf( "ERROR: Could not open %S: %d\n", Context->FileName, GetLastError() );
+            return FALSE;
+        }
+    }
+
+    QueryPerformanceCounter( &start );
+
+    for (index = 0; (index < Context->Iterations) && result; index++) {
+
+        switch (Operation) {
+
+        case BenchCreate:
+
+            file = CreateFileW( Context->FileName,
+                                GENERIC_READ,
+                                FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                NULL,
+                                OPEN_EXISTING,
+                                FILE_ATTRIBUTE_NORMAL,
+                                NULL );
+
+            if (file == INVALID_HANDLE_VALUE) {
+
+                result = FALSE;
+                break;
+            }
+
+            CloseHandle( file );
+            file = INVALID_HANDLE_VALUE;
+            break;
+
+        case BenchRead:
+
+            ZeroMemory( &overlapped, sizeof( overlapped ) );
+            result = ReadFile( file,
+                               Context->Buffer,
+                               sizeof( Context->Buffer ),
+                               &bytesTransferred,
+                               &overlapped );
+            break;
+
+        case BenchWrite:
+
+            ZeroMemory( &overlapped, sizeof( overlapped ) );
+            result = WriteFile( file,
+                                Context->Buffer,
+                                sizeof( Context->Buffer ),
+                                &bytesTransferred,
+                                &overlapped );
+            break;
+
+        case BenchQueryDirectory:
+
+            //
+            //  One iteration enumerates the whole work directory.
+            //
+
+            find = FindFirstFileExW( Context->SearchPattern,
+                                     FindExInfoBasic,
+                                     &findData,
+                                     FindExSearchNameMatch,
+                                     NULL,
+                                     FIND_FIRST_EX_LARGE_FETCH );
+
+            if (find == INVALID_HANDLE_VALUE) {
+
+                result = FALSE;
+                break;
+            }
+
+            while (FindNextFileW( find, &findData )) {
+
+                //
+                //  Only the enumeration itself is measured.
+                //
+            }
+
+            FindClose( find );
+            break;
+
+        default:
+
+            result = FALSE;
+            break;
+        }
+    }
+
+    QueryPerformanceCounter( &end );
+
+    if (!result) {
+
+        printf( "ERROR: %s failed: %d\n", OperationNames[Operation], GetLastError() );
+    }
+
+    if (file != INVALID_HANDLE_VALUE) {
+
+        CloseHandle( file );
+    }
+
+    *Ticks = end.QuadPart - start.QuadPart;
+    return result;
+}
+
+
+BOOL
+MeasureOperations (
+    _In_ PFLTBENCH_CONTEXT Context,
+    _Out_writes_(BenchOperationCount) double *Nanoseconds
+    )
+/*++
+
+Routine Description:
+
+    This runs every storm Context->Passes times and keeps the fastest pass
+    of each, which is the one least disturbed by the rest of the system.
+
+Arguments:
+
+    Context - The benchmark context.
+
+    Nanoseconds - Receives the time per operation of each storm.
+
+Return Value:
+
+    TRUE if every storm succeeded.
+
+--*/
+{
+    LONGLONG ticks;
+    LONGLONG best;
+    ULONG operation;
+    ULONG pass;
+
+    for (operation = 0; operation < BenchOperationCount; operation++) {
+
+        //
+        //  The first storm is not measured. It brings the file, the
+        //  directory and the code paths into the caches.
+        //
+
+        if (!RunStorm( Context, (FLTBENCH_OPERATION)operation, &ticks )) {
+
+            return FALSE;
+        }
+
+        best = MAXLONGLONG;
+
+        for (pass = 0; pass < Context->Passes; pass++) {
+
+            if (!RunStorm( Context, (FLTBENCH_OPERATION)operation, &ticks )) {
+
+                return FALSE;
+            }
+
+            best = min( best, ticks );
+        }
+
+        Nanoseconds[operation] = ((double)best * 1000000000.0) /
+                                 ((double)Context->Frequency.QuadPart * Context->Iterations);
+    }
+
+    return TRUE;
+}
+
+
+int _cdecl
+wmain (
+    _In_ int argc,
+    _In_reads_(argc) WCHAR *argv[]
+    )
+{
+    PFLTBENCH_CONTEXT context = NULL;
+    PCWSTR filterName;
+    WCHAR volumeName[MAX_PATH];
+    WCHAR instanceName[FLTBENCH_INSTANCE_NAME_SIZE];
+    double attached[BenchOperationCount];
+    double detached[BenchOperationCount];
+    BOOLEAN wasAttached = FALSE;
+    BOOLEAN isAttached = FALSE;
+    BOOLEAN filesCreated = FALSE;
+    HRESULT hResult;
+    size_t length;
+    ULONG operation;
+    int returnValue = 1;
+
+    if ((argc < 3) || (argc > 5)) {
+
+        Usage();
+        return 1;
+    }
+
+    filterName = argv[1];
+
+    context = calloc( 1, sizeof( FLTBENCH_CONTEXT ) );
+
+    if (context == NULL) {
+
+        printf( "ERROR: Out of memory\n" );
+        return 1;
+    }
+
+    context->Iterations = (argc > 3) ? wcstoul( argv[3], NULL, 10 ) : FLTBENCH_DEFAULT_ITERATIONS;
+    context->Passes = (argc > 4) ? wcstoul( argv[4], NULL, 10 ) : FLTBENCH_DEFAULT_PASSES;
+
+    if ((context->Iterations == 0) || (context->Passes == 0)) {
+
+        Usage();
+        goto main_cleanup;
+    }
+
+    QueryPerformanceFrequency( &context->Frequency );
+
+    swprintf_s( context->Directory, MAX_PATH, L"%s\\%s", argv[2], FLTBENCH_WORK_DIRECTORY );
+    swprintf_s( context->SearchPattern, MAX_PATH, L"%s\\*", context->Directory );
+    swprintf_s( context->FileName, MAX_PATH, L"%s\\file000.dat", context->Directory );
+
+    //
+    //  FltMgr names volumes by drive letter without the trailing backslash,
+    //  for example "C:".
+    //
+
+    if (!GetVolumePathNameW( argv[2], volumeName, MAX_PATH )) {
+
+        printf( "ERROR: Could not find the volume of %S: %d\n", argv[2], GetLastError() );
+        goto main_cleanup;
+    }
+
+    length = wcslen( volumeName );
+
+    if ((length > 0) && (volumeName[length - 1] == L'\\')) {
+
+        volumeName[length - 1] = UNICODE_NULL;
+    }
+
+    if (!PrepareFiles( context )) {
+
+        goto main_cleanup;
+    }
+
+    filesCreated = TRUE;
+
+    //
+    //  Attach the filter, or find out that it is attached already so that
+    //  it can be left attached at the end.
+    //
+
+    hResult = FilterAttach( filterName,
+                            volumeName,
+                            NULL,
+                            sizeof( instanceName ),
+                            instanceName );
+
+    if (hResult == HRESULT_FROM_WIN32( ERROR_FLT_INSTANCE_ALTITUDE_COLLISION ) ||
+        hResult == HRESULT_FROM_WIN32( ERROR_FLT_INSTANCE_NAME_COLLISION )) {
+
+        wasAttached = TRUE;
+
+    } else if (FAILED( hResult )) {
+
+        printf( "ERROR: Could not attach %S to %S: 0x%08x\n", filterName, volumeName, hResult );
+        goto main_cleanup;
+    }
+
+    isAttached = TRUE;
+
+    printf( "Measuring %S on %S, %u iterations, best of %u passes\n",
+            filterName,
+            volumeName,
+            context->Iterations,
+            context->Passes );
+
+    if (!MeasureOperations( context, attached )) {
+
+        goto main_cleanup;
+    }
+
+    hResult = FilterDetach( filterName, volumeName, NULL );
+
+    if (FAILED( hResult )) {
+
+        printf( "ERROR: Could not detach %S from %S: 0x%08x\n", filterName, volumeName, hResult );
+        goto main_cleanup;
+    }
+
+    isAttached = FALSE;
+
+    if (!MeasureOperations( context, detached )) {
+
+        goto main_cleanup;
+    }
+
+    printf( "\n%-16s %14s %14s %14s\n", "operation", "detached ns", "attached ns", "added ns" );
+
+    for (operation = 0; operation < BenchOperationCount; operation++) {
+
+        printf( "%-16s %14.0f %14.0f %14.0f (%+.1f%%)\n",
+                OperationNames[operation],
+                detached[operation],
+                attached[operation],
+                attached[operation] - detached[operation],
+                ((attached[operation] - detached[operation]) * 100.0) / detached[operation] );
+    }
+
+    returnValue = 0;
+
+main_cleanup:
+
+    //
+    //  Leave the filter attached only if it was attached before.
+    //
+
+    if (isAttached && !wasAttached) {
+
+        FilterDetach( filterName, volumeName, NULL );
+
+    } else if (!isAttached && wasAttached) {
+
+        FilterAttach( filterName, volumeName, NULL, 0, NULL );
+    }
+
+    if (filesCreated) {
+
+        CleanupFiles( context );
+    }
+
+    free( context );
+
+    return returnValue;
+}
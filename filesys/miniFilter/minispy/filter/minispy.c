@@ -133,6 +133,10 @@ Return Value:
         InitializeListHead( &MiniSpyData.OutputBufferList );
         KeInitializeSpinLock( &MiniSpyData.OutputBufferLock );
 
+        FltInitializePushLock( &MiniSpyData.FilterLock );
+        MiniSpyData.FilterFlags = 0;
+        MiniSpyData.MinLatency = 0;
+
         ExInitializeNPagedLookasideList( &MiniSpyData.FreeBufferList,
                                          NULL,
                                          NULL,
@@ -141,6 +145,24 @@ Return Value:
                                          SPY_TAG,
                                          0 );
 
+#if MINISPY_WIN7
+
+        //
+        //  Writers to the shared log rings run on every processor, so use
+        //  a cache aware rundown to keep them from contending on one line.
+        //
+
+        MiniSpyData.SharedLogRundown = ExAllocateCacheAwareRundownProtection( NonPagedPoolNx,
+                                                                               SPY_TAG );
+
+        if (MiniSpyData.SharedLogRundown == NULL) {
+
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            leave;
+        }
+
+#endif
+
 #if MINISPY_VISTA
 
         //
@@ -225,6 +247,16 @@ Return Value:
              }
 
              ExDeleteNPagedLookasideList( &MiniSpyData.FreeBufferList );
+             FltDeletePushLock( &MiniSpyData.FilterLock );
+
+#if MINISPY_WIN7
+
+             if (NULL != MiniSpyData.SharedLogRundown) {
+                 ExFreeCacheAwareRundownProtection( MiniSpyData.SharedLogRundown );
+                 MiniSpyData.SharedLogRundown = NULL;
+             }
+
+#endif
         }
     }
 
@@ -298,6 +330,16 @@ Return value
 
     UNREFERENCED_PARAMETER( ConnectionCookie );
 
+#if MINISPY_WIN7
+
+    //
+    //  Stop logging to the client's shared log rings and unmap them.
+    //
+
+    SpyUnmapSharedLog();
+
+#endif
+
     //
     //  Close our handle
     //
@@ -343,8 +385,21 @@ Return Value:
 
     FltUnregisterFilter( MiniSpyData.Filter );
 
+#if MINISPY_WIN7
+
+    //
+    //  The client has been disconnected by now, which unmapped the rings,
+    //  but make sure nothing is left behind.
+    //
+
+    SpyUnmapSharedLog();
+    ExFreeCacheAwareRundownProtection( MiniSpyData.SharedLogRundown );
+
+#endif
+
     SpyEmptyOutputBufferList();
     ExDeleteNPagedLookasideList( &MiniSpyData.FreeBufferList );
+    FltDeletePushLock( &MiniSpyData.FilterLock );
 
     return STATUS_SUCCESS;
 }
@@ -418,6 +473,7 @@ Return Value:
 --*/
 {
     MINISPY_COMMAND command;
+    MINISPY_FILTER filter;
     NTSTATUS status;
 
     PAGED_CODE();
@@ -521,6 +577,69 @@ Return Value:
                                     ReturnOutputBufferLength );
                 break;
 
+#if MINISPY_WIN7
+
+            case MapMiniSpyLog:
+
+                //
+                //  Map the shared log rings into the caller and return their
+                //  layout.  Verify we have a valid user buffer including
+                //  valid alignment.
+                //
+
+                if ((OutputBufferSize < sizeof( MINISPY_LOG_MAPPING )) ||
+                    (OutputBuffer == NULL)) {
+
+                    status = STATUS_INVALID_PARAMETER;
+                    break;
+                }
+
+                if (!IS_ALIGNED(OutputBuffer,sizeof(ULONG))) {
+
+                    status = STATUS_DATATYPE_MISALIGNMENT;
+                    break;
+                }
+
+                status = SpyMapSharedLog( OutputBuffer,
+                                          OutputBufferSize,
+                                          ReturnOutputBufferLength );
+                break;
+
+#endif
+
+            case SetMiniSpyFilter:
+
+                //
+                //  Replace the kernel side filter.  The filter follows the
+                //  command in the input buffer.
+                //
+
+                if (InputBufferSize < (FIELD_OFFSET(COMMAND_MESSAGE,Data) +
+                                       sizeof(MINISPY_FILTER))) {
+
+                    status = STATUS_INVALID_PARAMETER;
+                    break;
+                }
+
+                //
+                //  Capture the filter: the message is raw user mode buffer,
+                //  so need to protect with exception handler
+                //
+
+                try {
+
+                    RtlCopyMemory( &filter,
+                                   ((PCOMMAND_MESSAGE) InputBuffer)->Data,
+                                   sizeof(MINISPY_FILTER) );
+
+                } except (SpyExceptionFilter( GetExceptionInformation(), TRUE )) {
+
+                    return GetExceptionCode();
+                }
+
+                status = SpySetFilter( &filter );
+                *ReturnOutputBufferLength = 0;
+                break;
 
             case GetMiniSpyVersion:
 
@@ -643,6 +762,16 @@ Return Value:
 
 #endif
 
+    //
+    //  Skip operations the client's filter is not interested in before we
+    //  spend anything on them.
+    //
+
+    if (!SpyShouldLogOperation( Data, FltObjects )) {
+
+        return FLT_PREOP_SUCCESS_NO_CALLBACK;
+    }
+
     //
     //  Try and get a log record
     //
@@ -971,6 +1100,16 @@ Return Value:
 
     SpyLogPostOperationData( Data, recordList );
 
+    //
+    //  Drop operations that completed faster than the filter asked for.
+    //
+
+    if (!SpyShouldLogCompletion( recordList )) {
+
+        SpyFreeRecord( recordList );
+        return FLT_POSTOP_FINISHED_PROCESSING;
+    }
+
     //
     //  Log reparse tag information if specified.
     //
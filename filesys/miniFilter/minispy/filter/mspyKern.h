@@ -111,6 +111,25 @@ typedef enum _ECP_TYPE {
 
 #endif
 
+#if MINISPY_WIN7
+
+//
+//  Filter-private state for one shared log ring.  The write offset we trust
+//  is kept here, the one in the shared header is only published to the
+//  consumer.  Each ring is only written by its own processor at
+//  DISPATCH_LEVEL so no lock is needed.
+//
+
+typedef struct DECLSPEC_CACHEALIGN _SPY_RING {
+
+    PMINISPY_RING_HEADER Header;
+    PUCHAR Data;
+    ULONG WriteOffset;
+
+} SPY_RING, *PSPY_RING;
+
+#endif
+
 //---------------------------------------------------------------------------
 //      Global variables
 //---------------------------------------------------------------------------
@@ -210,6 +229,41 @@ typedef struct _MINISPY_DATA {
 
     PFLT_ENLIST_IN_TRANSACTION PFltEnlistInTransaction;
 
+#endif
+
+    //
+    //  The kernel side filter set by the client.  FilterFlags is a copy of
+    //  Filter.Flags that is read without the lock so that we pay nothing
+    //  when no filter is set; the rest of Filter is protected by FilterLock.
+    //  MinLatency is also read without the lock by the post operation
+    //  callback, which may run at DPC level.
+    //
+
+    EX_PUSH_LOCK FilterLock;
+    MINISPY_FILTER Filter;
+    __volatile ULONG FilterFlags;
+    __volatile ULONG MinLatency;
+    __volatile LONG SampleCount;
+
+#if MINISPY_WIN7
+
+    //
+    //  Shared memory log rings, mapped into the client process on request.
+    //  SharedLogActive is set while the rings may be written and the
+    //  rundown protects the rings from being unmapped under a writer.
+    //
+
+    __volatile LONG SharedLogActive;
+    PEX_RUNDOWN_REF_CACHE_AWARE SharedLogRundown;
+
+    PMDL SharedLogMdl;
+    PVOID SharedLogKernelBase;
+    PVOID SharedLogUserBase;
+    PEPROCESS SharedLogProcess;
+
+    ULONG SharedLogRingCount;
+    SPY_RING SharedLogRings[MINISPY_MAX_RINGS];
+
 #endif
 
 } MINISPY_DATA, *PMINISPY_DATA;
@@ -402,6 +456,38 @@ SpyEmptyOutputBufferList (
     VOID
     );
 
+NTSTATUS
+SpySetFilter (
+    _In_ PMINISPY_FILTER Filter
+    );
+
+BOOLEAN
+SpyShouldLogOperation (
+    _In_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects
+    );
+
+BOOLEAN
+SpyShouldLogCompletion (
+    _In_ PRECORD_LIST RecordList
+    );
+
+#if MINISPY_WIN7
+
+NTSTATUS
+SpyMapSharedLog (
+    _Out_writes_bytes_to_(OutputBufferLength,*ReturnOutputBufferLength) PUCHAR OutputBuffer,
+    _In_ ULONG OutputBufferLength,
+    _Out_ PULONG ReturnOutputBufferLength
+    );
+
+VOID
+SpyUnmapSharedLog (
+    VOID
+    );
+
+#endif
+
 VOID
 SpyDeleteTxfContext (
     _Inout_ PFLT_CONTEXT  Context,
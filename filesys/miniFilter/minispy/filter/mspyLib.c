@@ -35,10 +35,24 @@ Environment:
 
 #ifdef ALLOC_PRAGMA
     #pragma alloc_text(INIT, SpyReadDriverParameters)
+    #pragma alloc_text(PAGE, SpySetFilter)
 #if MINISPY_VISTA
     #pragma alloc_text(PAGE, SpyBuildEcpDataString)
     #pragma alloc_text(PAGE, SpyParseEcps)
 #endif
+#if MINISPY_WIN7
+    #pragma alloc_text(PAGE, SpyMapSharedLog)
+    #pragma alloc_text(PAGE, SpyUnmapSharedLog)
+#endif
+#endif
+
+#if MINISPY_WIN7
+
+BOOLEAN
+SpyLogToSharedLog (
+    _In_ PRECORD_LIST RecordList
+    );
+
 #endif
 
 UCHAR TxNotificationToMinorCode (
@@ -1230,11 +1244,148 @@ Return Value:
 {
     KIRQL oldIrql;
 
+#if MINISPY_WIN7
+
+    //
+    //  If user mode has mapped the shared log then the record goes into
+    //  the ring for this processor and we are done with it.
+    //
+
+    if (SpyLogToSharedLog( RecordList )) {
+
+        SpyFreeRecord( RecordList );
+        return;
+    }
+
+#endif
+
     KeAcquireSpinLock(&MiniSpyData.OutputBufferLock, &oldIrql);
     InsertTailList(&MiniSpyData.OutputBufferList, &RecordList->List);
     KeReleaseSpinLock(&MiniSpyData.OutputBufferLock, oldIrql);
 }
 
+#if MINISPY_WIN7
+
+BOOLEAN
+SpyLogToSharedLog (
+    _In_ PRECORD_LIST RecordList
+    )
+/*++
+
+Routine Description:
+
+    This routine copies the given log record into the shared log ring for
+    the current processor, if the shared log is mapped.  We raise to
+    DISPATCH_LEVEL while touching the ring so that we are its only writer.
+
+    If the ring is full the record is dropped and counted in the ring
+    header so the consumer can report it.
+
+    NOTE:  This code must be NON-PAGED because it can be called on the
+           paging path or at DPC level.
+
+Arguments:
+
+    RecordList - The record to log.  The caller still owns and frees it.
+
+Return Value:
+
+    TRUE if the record was consumed by the shared log (copied or dropped),
+    FALSE if it should be queued for SpyGetLog.
+
+--*/
+{
+    PLOG_RECORD logRecord = &RecordList->LogRecord;
+    PSPY_RING ring;
+    ULONG length;
+    ULONG used;
+    ULONG position;
+    ULONG contiguous;
+    ULONG needed;
+    KIRQL oldIrql;
+
+    if (!MiniSpyData.SharedLogActive) {
+
+        return FALSE;
+    }
+
+    if (!ExAcquireRundownProtectionCacheAware( MiniSpyData.SharedLogRundown )) {
+
+        return FALSE;
+    }
+
+    //
+    //  If no filename was set then make it into a NULL file name, as
+    //  SpyGetLog does.
+    //
+
+    if (REMAINING_NAME_SPACE( logRecord ) == MAX_NAME_SPACE) {
+
+        logRecord->Length += ROUND_TO_SIZE( sizeof( UNICODE_NULL ), sizeof( PVOID ) );
+        logRecord->Name[0] = UNICODE_NULL;
+    }
+
+    length = ROUND_TO_SIZE( logRecord->Length, sizeof( PVOID ) );
+
+    KeRaiseIrql( DISPATCH_LEVEL, &oldIrql );
+
+    ring = &MiniSpyData.SharedLogRings[KeGetCurrentProcessorNumberEx( NULL ) % MiniSpyData.SharedLogRingCount];
+
+    //
+    //  The read offset is written by user mode, so only use it to decide
+    //  whether there is room.  A nonsense value makes the ring look full.
+    //
+
+    used = ring->WriteOffset - ring->Header->ReadOffset;
+
+    position = ring->WriteOffset & (MINISPY_RING_SIZE - 1);
+    contiguous = MINISPY_RING_SIZE - position;
+
+    needed = length;
+
+    if (length > contiguous) {
+
+        needed += contiguous;
+    }
+
+    if ((used > MINISPY_RING_SIZE) || (needed > MINISPY_RING_SIZE - used)) {
+
+        ring->Header->DroppedRecords += 1;
+
+    } else {
+
+        //
+        //  Skip the tail of the ring if the record doesn't fit there.
+        //
+
+        if (length > contiguous) {
+
+            *(PULONG)Add2Ptr( ring->Data, position ) = 0;
+            ring->WriteOffset += contiguous;
+            position = 0;
+        }
+
+        RtlCopyMemory( Add2Ptr( ring->Data, position ), logRecord, logRecord->Length );
+        ((PLOG_RECORD)Add2Ptr( ring->Data, position ))->Length = length;
+
+        ring->WriteOffset += length;
+
+        //
+        //  Publish the record only once it is completely in place.
+        //
+
+        InterlockedExchange( (volatile LONG *)&ring->Header->WriteOffset, ring->WriteOffset );
+    }
+
+    KeLowerIrql( oldIrql );
+
+    ExReleaseRundownProtectionCacheAware( MiniSpyData.SharedLogRundown );
+
+    return TRUE;
+}
+
+#endif
+
 
 NTSTATUS
 SpyGetLog (
@@ -1437,6 +1588,475 @@ Return Value:
     KeReleaseSpinLock( &MiniSpyData.OutputBufferLock, oldIrql );
 }
 
+#if MINISPY_WIN7
+
+NTSTATUS
+SpyMapSharedLog (
+    _Out_writes_bytes_to_(OutputBufferLength,*ReturnOutputBufferLength) PUCHAR OutputBuffer,
+    _In_ ULONG OutputBufferLength,
+    _Out_ PULONG ReturnOutputBufferLength
+    )
+/*++
+
+Routine Description:
+
+    This routine allocates the shared log rings, one per active processor
+    up to MINISPY_MAX_RINGS, maps them into the calling process and returns
+    their location and layout.  Once this returns successfully new records
+    go to the rings instead of the OutputBufferList.
+
+    This must be called in the context of the client process.  The mapping
+    is torn down by SpyUnmapSharedLog when the client disconnects.
+
+Arguments:
+
+    OutputBuffer - The user's buffer to receive a MINISPY_LOG_MAPPING.
+
+    OutputBufferLength - The size in bytes of OutputBuffer
+
+    ReturnOutputBufferLength - The amount of data actually written into the
+        OutputBuffer.
+
+Return Value:
+
+    STATUS_SUCCESS if the rings are mapped, an error status otherwise.
+
+--*/
+{
+    PMDL mdl;
+    PVOID kernelBase = NULL;
+    PVOID userBase = NULL;
+    ULONG ringCount;
+    SIZE_T totalSize;
+    ULONG index;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    PAGED_CODE();
+
+    *ReturnOutputBufferLength = 0;
+
+    if (OutputBufferLength < sizeof( MINISPY_LOG_MAPPING )) {
+
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    //
+    //  Only one mapping per connection.
+    //
+
+    if (MiniSpyData.SharedLogMdl != NULL) {
+
+        return STATUS_INVALID_DEVICE_STATE;
+    }
+
+    ringCount = KeQueryActiveProcessorCountEx( ALL_PROCESSOR_GROUPS );
+
+    if (ringCount > MINISPY_MAX_RINGS) {
+
+        ringCount = MINISPY_MAX_RINGS;
+    }
+
+    totalSize = ROUND_TO_PAGES( (SIZE_T)ringCount * MINISPY_RING_STRIDE );
+
+    mdl = MmAllocatePagesForMdlEx( RtlConvertLongToLargeInteger( 0 ),
+                                   RtlConvertLongToLargeInteger( -1 ),
+                                   RtlConvertLongToLargeInteger( 0 ),
+                                   totalSize,
+                                   MmCached,
+                                   MM_ALLOCATE_FULLY_REQUIRED );
+
+    if (mdl == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    try {
+
+        kernelBase = MmMapLockedPagesSpecifyCache( mdl,
+                                                   KernelMode,
+                                                   MmCached,
+                                                   NULL,
+                                                   FALSE,
+                                                   NormalPagePriority | MdlMappingNoExecute );
+
+        if (kernelBase == NULL) {
+
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            leave;
+        }
+
+        RtlZeroMemory( kernelBase, totalSize );
+
+        //
+        //  Mapping into user mode raises on failure.
+        //
+
+        try {
+
+            userBase = MmMapLockedPagesSpecifyCache( mdl,
+                                                     UserMode,
+                                                     MmCached,
+                                                     NULL,
+                                                     FALSE,
+                                                     NormalPagePriority );
+
+        } except (EXCEPTION_EXECUTE_HANDLER) {
+
+            status = GetExceptionCode();
+            leave;
+        }
+
+        //
+        //  Protect access to raw user-mode OutputBuffer with an exception handler
+        //
+
+        try {
+
+            ((PMINISPY_LOG_MAPPING)OutputBuffer)->BaseAddress = (ULONGLONG)(ULONG_PTR)userBase;
+            ((PMINISPY_LOG_MAPPING)OutputBuffer)->RingCount = ringCount;
+            ((PMINISPY_LOG_MAPPING)OutputBuffer)->RingSize = MINISPY_RING_SIZE;
+            ((PMINISPY_LOG_MAPPING)OutputBuffer)->RingStride = MINISPY_RING_STRIDE;
+            ((PMINISPY_LOG_MAPPING)OutputBuffer)->Reserved = 0;
+
+        } except (SpyExceptionFilter( GetExceptionInformation(), TRUE )) {
+
+            status = GetExceptionCode();
+            leave;
+        }
+
+        for (index = 0; index < ringCount; index += 1) {
+
+            MiniSpyData.SharedLogRings[index].Header = Add2Ptr( kernelBase, index * MINISPY_RING_STRIDE );
+            MiniSpyData.SharedLogRings[index].Data = Add2Ptr( kernelBase, index * MINISPY_RING_STRIDE + MINISPY_RING_HEADER_SIZE );
+            MiniSpyData.SharedLogRings[index].WriteOffset = 0;
+        }
+
+        MiniSpyData.SharedLogMdl = mdl;
+        MiniSpyData.SharedLogKernelBase = kernelBase;
+        MiniSpyData.SharedLogUserBase = userBase;
+        MiniSpyData.SharedLogRingCount = ringCount;
+        MiniSpyData.SharedLogProcess = PsGetCurrentProcess();
+        ObReferenceObject( MiniSpyData.SharedLogProcess );
+
+        //
+        //  Start logging to the rings.
+        //
+
+        InterlockedExchange( &MiniSpyData.SharedLogActive, TRUE );
+
+        *ReturnOutputBufferLength = sizeof( MINISPY_LOG_MAPPING );
+
+    } finally {
+
+        if (!NT_SUCCESS( status )) {
+
+            if (userBase != NULL) {
+
+                MmUnmapLockedPages( userBase, mdl );
+            }
+
+            if (kernelBase != NULL) {
+
+                MmUnmapLockedPages( kernelBase, mdl );
+            }
+
+            MmFreePagesFromMdl( mdl );
+            ExFreePool( mdl );
+        }
+    }
+
+    return status;
+}
+
+
+VOID
+SpyUnmapSharedLog (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    This routine stops logging to the shared log rings, waits for any
+    writer still using them, and unmaps and frees them.  Records logged
+    after this go back to the OutputBufferList.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    KAPC_STATE apcState;
+    BOOLEAN attached = FALSE;
+
+    PAGED_CODE();
+
+    if (MiniSpyData.SharedLogMdl == NULL) {
+
+        return;
+    }
+
+    InterlockedExchange( &MiniSpyData.SharedLogActive, FALSE );
+    ExWaitForRundownProtectionReleaseCacheAware( MiniSpyData.SharedLogRundown );
+
+    //
+    //  The user mapping has to be removed in the process it was made in.
+    //
+
+    if (PsGetCurrentProcess() != MiniSpyData.SharedLogProcess) {
+
+        KeStackAttachProcess( MiniSpyData.SharedLogProcess, &apcState );
+        attached = TRUE;
+    }
+
+    MmUnmapLockedPages( MiniSpyData.SharedLogUserBase, MiniSpyData.SharedLogMdl );
+
+    if (attached) {
+
+        KeUnstackDetachProcess( &apcState );
+    }
+
+    ObDereferenceObject( MiniSpyData.SharedLogProcess );
+
+    MmUnmapLockedPages( MiniSpyData.SharedLogKernelBase, MiniSpyData.SharedLogMdl );
+    MmFreePagesFromMdl( MiniSpyData.SharedLogMdl );
+    ExFreePool( MiniSpyData.SharedLogMdl );
+
+    MiniSpyData.SharedLogMdl = NULL;
+    MiniSpyData.SharedLogKernelBase = NULL;
+    MiniSpyData.SharedLogUserBase = NULL;
+    MiniSpyData.SharedLogProcess = NULL;
+    MiniSpyData.SharedLogRingCount = 0;
+
+    //
+    //  Allow the rings to be used again by the next connection.
+    //
+
+    ExReInitializeRundownProtectionCacheAware( MiniSpyData.SharedLogRundown );
+}
+
+#endif
+
+//---------------------------------------------------------------------------
+//                    Kernel side filtering routines
+//---------------------------------------------------------------------------
+
+NTSTATUS
+SpySetFilter (
+    _In_ PMINISPY_FILTER Filter
+    )
+/*++
+
+Routine Description:
+
+    This routine validates the given filter and makes it the one applied
+    to new operations.  A filter with no flags set turns filtering off.
+
+Arguments:
+
+    Filter - A captured copy of the filter sent by the client.
+
+Return Value:
+
+    STATUS_SUCCESS if the filter was set, STATUS_INVALID_PARAMETER if it is
+    malformed.
+
+--*/
+{
+    PAGED_CODE();
+
+    if (FlagOn( Filter->Flags, ~MINISPY_FILTER_VALID_FLAGS )) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (FlagOn( Filter->Flags, MINISPY_FILTER_PATH_PREFIX ) &&
+        ((Filter->PathPrefixLength == 0) ||
+         (Filter->PathPrefixLength > sizeof( Filter->PathPrefix )) ||
+         !IS_ALIGNED( Filter->PathPrefixLength, sizeof( WCHAR ) ))) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (FlagOn( Filter->Flags, MINISPY_FILTER_SAMPLE ) &&
+        (Filter->SampleRate == 0)) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    FltAcquirePushLockExclusive( &MiniSpyData.FilterLock );
+
+    RtlCopyMemory( &MiniSpyData.Filter, Filter, sizeof( MINISPY_FILTER ) );
+
+    MiniSpyData.MinLatency = FlagOn( Filter->Flags, MINISPY_FILTER_MIN_LATENCY ) ?
+                                Filter->MinLatency : 0;
+    MiniSpyData.SampleCount = 0;
+    MiniSpyData.FilterFlags = Filter->Flags;
+
+    FltReleasePushLock( &MiniSpyData.FilterLock );
+
+    return STATUS_SUCCESS;
+}
+
+
+BOOLEAN
+SpyShouldLogOperation (
+    _In_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects
+    )
+/*++
+
+Routine Description:
+
+    This routine applies the pre operation conditions of the current
+    filter to the given operation.  It is called before a log record is
+    allocated, so that operations we are not interested in cost as little
+    as possible.  The cheap conditions are checked first; the name is only
+    queried when a path prefix is set and everything else has passed.
+
+    NOTE:  This code must be NON-PAGED because it can be called on the
+           paging path.
+
+Arguments:
+
+    Data - Contains information about the given operation.
+
+    FltObjects - Contains pointers to the various objects that are pertinent
+        to this operation.
+
+Return Value:
+
+    TRUE if the operation should be logged, FALSE otherwise.
+
+--*/
+{
+    ULONG flags = MiniSpyData.FilterFlags;
+    UCHAR majorFunction = Data->Iopb->MajorFunction;
+    PFLT_FILE_NAME_INFORMATION nameInfo;
+    UNICODE_STRING prefix;
+    ULONG sampleRate = 0;
+    BOOLEAN result = TRUE;
+    NTSTATUS status;
+
+    if (flags == 0) {
+
+        return TRUE;
+    }
+
+    FltAcquirePushLockShared( &MiniSpyData.FilterLock );
+
+    flags = MiniSpyData.FilterFlags;
+
+    if (FlagOn( flags, MINISPY_FILTER_MAJOR_FUNCTION ) &&
+        !FlagOn( MiniSpyData.Filter.MajorFunctions[majorFunction / 32],
+                 1 << (majorFunction % 32) )) {
+
+        result = FALSE;
+
+    } else if (FlagOn( flags, MINISPY_FILTER_PROCESS_ID ) &&
+               (FltGetRequestorProcessId( Data ) != MiniSpyData.Filter.ProcessId)) {
+
+        result = FALSE;
+    }
+
+    if (FlagOn( flags, MINISPY_FILTER_SAMPLE )) {
+
+        sampleRate = MiniSpyData.Filter.SampleRate;
+    }
+
+    FltReleasePushLock( &MiniSpyData.FilterLock );
+
+    //
+    //  The name query can send I/O, so don't hold the lock across it.
+    //
+
+    if (result && FlagOn( flags, MINISPY_FILTER_PATH_PREFIX )) {
+
+        if (FltObjects->FileObject == NULL) {
+
+            return FALSE;
+        }
+
+        status = FltGetFileNameInformation( Data,
+                                            FLT_FILE_NAME_NORMALIZED |
+                                                MiniSpyData.NameQueryMethod,
+                                            &nameInfo );
+
+        if (!NT_SUCCESS( status )) {
+
+            return FALSE;
+        }
+
+        FltAcquirePushLockShared( &MiniSpyData.FilterLock );
+
+        if (FlagOn( MiniSpyData.FilterFlags, MINISPY_FILTER_PATH_PREFIX )) {
+
+            prefix.Buffer = MiniSpyData.Filter.PathPrefix;
+            prefix.Length = MiniSpyData.Filter.PathPrefixLength;
+            prefix.MaximumLength = MiniSpyData.Filter.PathPrefixLength;
+
+            result = RtlPrefixUnicodeString( &prefix, &nameInfo->Name, TRUE );
+        }
+
+        FltReleasePushLock( &MiniSpyData.FilterLock );
+
+        FltReleaseFileNameInformation( nameInfo );
+    }
+
+    //
+    //  Sample last, so the rate applies to the operations that matched.
+    //
+
+    if (result && (sampleRate > 1)) {
+
+        result = (((ULONG)InterlockedIncrement( &MiniSpyData.SampleCount ) % sampleRate) == 0);
+    }
+
+    return result;
+}
+
+
+BOOLEAN
+SpyShouldLogCompletion (
+    _In_ PRECORD_LIST RecordList
+    )
+/*++
+
+Routine Description:
+
+    This routine applies the minimum latency condition of the current
+    filter to a completed operation.
+
+    NOTE:  This code must be NON-PAGED because it can be called at DPC level.
+
+Arguments:
+
+    RecordList - The record for the operation, with both its originating
+        and completion times set.
+
+Return Value:
+
+    TRUE if the record should be logged, FALSE if it should be freed.
+
+--*/
+{
+    PRECORD_DATA recordData = &RecordList->LogRecord.Data;
+    ULONG minLatency = MiniSpyData.MinLatency;
+
+    if (minLatency == 0) {
+
+        return TRUE;
+    }
+
+    return ((recordData->CompletionTime.QuadPart -
+             recordData->OriginatingTime.QuadPart) >= (LONGLONG)minLatency);
+}
+
 //---------------------------------------------------------------------------
 //                    Logging routines
 //---------------------------------------------------------------------------
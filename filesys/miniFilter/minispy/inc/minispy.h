@@ -54,7 +54,7 @@ Environment:
 //
 
 #define MINISPY_MAJ_VERSION 2
-#define MINISPY_MIN_VERSION 0
+#define MINISPY_MIN_VERSION 1
 
 typedef struct _MINISPYVER {
 
@@ -183,7 +183,9 @@ typedef struct _RECORD_LIST {
 typedef enum _MINISPY_COMMAND {
 
     GetMiniSpyLog,
-    GetMiniSpyVersion
+    GetMiniSpyVersion,
+    MapMiniSpyLog,
+    SetMiniSpyFilter
 
 } MINISPY_COMMAND;
 
@@ -202,6 +204,92 @@ typedef struct _COMMAND_MESSAGE {
 
 #pragma warning(pop)
 
+//
+//  Shared memory log transport.
+//
+//  In response to MapMiniSpyLog the filter maps a set of per-processor rings
+//  into the calling process and returns a MINISPY_LOG_MAPPING describing
+//  them.  From then on records are copied into the ring of the processor
+//  that completes the operation instead of being queued for GetMiniSpyLog.
+//
+//  Each ring is RingStride bytes: a MINISPY_RING_HEADER followed by RingSize
+//  bytes of data.  The offsets in the header count bytes ever written and
+//  read and wrap at 2^32; the position in the data is the offset modulo
+//  RingSize.  Records are packed LOG_RECORDs whose Length is a multiple of
+//  a PVOID.  A Length of zero means the rest of the ring up to the wrap is
+//  unused.
+//
+//  Only the filter writes WriteOffset and DroppedRecords, and it advances
+//  WriteOffset only after the record is in place.  Only the consumer writes
+//  ReadOffset, after it is done with the records.  The two live in separate
+//  cache lines.
+//
+
+#define MINISPY_MAX_RINGS           64
+#define MINISPY_RING_SIZE           (128 * 1024)
+#define MINISPY_RING_HEADER_SIZE    128
+#define MINISPY_RING_STRIDE         (MINISPY_RING_HEADER_SIZE + MINISPY_RING_SIZE)
+
+typedef struct _MINISPY_RING_HEADER {
+
+    volatile ULONG WriteOffset;
+    volatile ULONG DroppedRecords;
+    ULONG Reserved1[14];
+
+    volatile ULONG ReadOffset;
+    ULONG Reserved2[15];
+
+} MINISPY_RING_HEADER, *PMINISPY_RING_HEADER;
+
+typedef struct _MINISPY_LOG_MAPPING {
+
+    ULONGLONG BaseAddress;
+    ULONG RingCount;
+    ULONG RingSize;
+    ULONG RingStride;
+    ULONG Reserved;
+
+} MINISPY_LOG_MAPPING, *PMINISPY_LOG_MAPPING;
+
+//
+//  Kernel side filtering.
+//
+//  SetMiniSpyFilter takes a MINISPY_FILTER in COMMAND_MESSAGE.Data.  An
+//  operation is logged only if it passes every condition whose bit is set in
+//  Flags; a Flags of zero logs everything.  Operations that fail a pre
+//  operation condition are not given a log record at all.
+//
+//  MajorFunctions is a bitmap indexed by the major function code as a UCHAR,
+//  so the negative FsFilter codes land at the top.  ProcessId is matched
+//  against the requestor of the operation.  PathPrefix is matched case
+//  insensitively against the start of the normalized name.  MinLatency is
+//  in 100ns units.  SampleRate keeps one of every SampleRate operations that
+//  pass the other conditions.
+//
+
+#define MINISPY_FILTER_MAJOR_FUNCTION       0x00000001
+#define MINISPY_FILTER_PROCESS_ID           0x00000002
+#define MINISPY_FILTER_PATH_PREFIX          0x00000004
+#define MINISPY_FILTER_MIN_LATENCY          0x00000008
+#define MINISPY_FILTER_SAMPLE               0x00000010
+
+#define MINISPY_FILTER_VALID_FLAGS          0x0000001F
+
+#define MINISPY_FILTER_MAX_PREFIX_CHARS     260
+
+typedef struct _MINISPY_FILTER {
+
+    ULONG Flags;
+    ULONG MajorFunctions[256 / 32];
+    ULONG ProcessId;
+    ULONG MinLatency;
+    ULONG SampleRate;
+
+    USHORT PathPrefixLength;    // in bytes, not including any NULL
+    WCHAR PathPrefix[MINISPY_FILTER_MAX_PREFIX_CHARS];
+
+} MINISPY_FILTER, *PMINISPY_FILTER;
+
 //
 //  The maximum number of BYTES that can be used to store the file name in the
 //  RECORD_LIST structure
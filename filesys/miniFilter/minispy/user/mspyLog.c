@@ -92,6 +92,289 @@ Return Value:
 }
 
 
+VOID
+DumpLogRecord(
+    _In_ PLOG_CONTEXT Context,
+    _Inout_ PLOG_RECORD LogRecord
+    )
+/*++
+
+Routine Description:
+
+    Write a single log record to the screen and/or the log file.
+
+Arguments:
+
+    Context - The logging context.
+
+    LogRecord - The record to output.  Reparse point records are translated
+        in place, so this must be a full RECORD_SIZE buffer in that case.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PRECORD_DATA pRecordData = &LogRecord->Data;
+
+    //
+    //  See if a reparse point entry
+    //
+
+    if (FlagOn(LogRecord->RecordType,RECORD_TYPE_FILETAG)) {
+
+        if (!TranslateFileTag( LogRecord )){
+
+            //
+            // If this is a reparse point that can't be interpreted, move on.
+            //
+
+            return;
+        }
+    }
+
+    if (Context->LogToScreen) {
+
+        ScreenDump( LogRecord->SequenceNumber,
+                    LogRecord->Name,
+                    pRecordData );
+    }
+
+    if (Context->LogToFile) {
+
+        FileDump( LogRecord->SequenceNumber,
+                  LogRecord->Name,
+                  pRecordData,
+                  Context->OutputFile );
+    }
+
+    //
+    //  The RecordType could also designate that we are out of memory
+    //  or hit our program defined memory limit, so check for these
+    //  cases.
+    //
+
+    if (FlagOn(LogRecord->RecordType,RECORD_TYPE_FLAG_OUT_OF_MEMORY)) {
+
+        if (Context->LogToScreen) {
+
+            printf( "M:  %08X System Out of Memory\n",
+                    LogRecord->SequenceNumber );
+        }
+
+        if (Context->LogToFile) {
+
+            fprintf( Context->OutputFile,
+                     "M:\t0x%08X\tSystem Out of Memory\n",
+                     LogRecord->SequenceNumber );
+        }
+
+    } else if (FlagOn(LogRecord->RecordType,RECORD_TYPE_FLAG_EXCEED_MEMORY_ALLOWANCE)) {
+
+        if (Context->LogToScreen) {
+
+            printf( "M:  %08X Exceeded Mamimum Allowed Memory Buffers\n",
+                    LogRecord->SequenceNumber );
+        }
+
+        if (Context->LogToFile) {
+
+            fprintf( Context->OutputFile,
+                     "M:\t0x%08X\tExceeded Mamimum Allowed Memory Buffers\n",
+                     LogRecord->SequenceNumber );
+        }
+    }
+}
+
+
+BOOLEAN
+MapSharedLog(
+    _Inout_ PLOG_CONTEXT Context
+    )
+/*++
+
+Routine Description:
+
+    Ask MiniSpy to map its per-processor log rings into this process.  If
+    this fails (for example an older filter) we keep using GetMiniSpyLog.
+
+Arguments:
+
+    Context - The logging context to receive the ring layout.
+
+Return Value:
+
+    TRUE if the shared log is mapped, FALSE otherwise.
+
+--*/
+{
+    COMMAND_MESSAGE commandMessage;
+    MINISPY_LOG_MAPPING mapping;
+    DWORD bytesReturned = 0;
+    HRESULT hResult;
+
+    commandMessage.Command = MapMiniSpyLog;
+
+    hResult = FilterSendMessage( Context->Port,
+                                 &commandMessage,
+                                 sizeof( COMMAND_MESSAGE ),
+                                 &mapping,
+                                 sizeof( mapping ),
+                                 &bytesReturned );
+
+    if (IS_ERROR( hResult ) ||
+        (bytesReturned < sizeof( mapping )) ||
+        (mapping.RingCount == 0) ||
+        (mapping.RingCount > MINISPY_MAX_RINGS)) {
+
+        return FALSE;
+    }
+
+    Context->SharedLog = (PUCHAR)(ULONG_PTR)mapping.BaseAddress;
+    Context->RingCount = mapping.RingCount;
+    Context->RingSize = mapping.RingSize;
+    Context->RingStride = mapping.RingStride;
+    ZeroMemory( Context->LastDropped, sizeof( Context->LastDropped ) );
+
+    return TRUE;
+}
+
+
+BOOLEAN
+DrainSharedLog(
+    _Inout_ PLOG_CONTEXT Context
+    )
+/*++
+
+Routine Description:
+
+    Output every record currently in the shared log rings.  Records are
+    read in place; only the ring's ReadOffset is written back, after we
+    are done with them.
+
+Arguments:
+
+    Context - The logging context.
+
+Return Value:
+
+    TRUE if any records were found, FALSE if all rings were empty.
+
+--*/
+{
+    PVOID alignedRecord[RECORD_SIZE/sizeof( PVOID )];
+    PMINISPY_RING_HEADER header;
+    PUCHAR data;
+    PLOG_RECORD pLogRecord;
+    ULONG writeOffset;
+    ULONG readOffset;
+    ULONG position;
+    ULONG dropped;
+    ULONG index;
+    BOOLEAN found = FALSE;
+
+    for (index = 0; index < Context->RingCount; index += 1) {
+
+        header = (PMINISPY_RING_HEADER)(Context->SharedLog + (SIZE_T)index * Context->RingStride);
+        data = (PUCHAR)header + MINISPY_RING_HEADER_SIZE;
+
+        //
+        //  Don't look at the records before we have seen the write offset
+        //  that publishes them.
+        //
+
+        writeOffset = header->WriteOffset;
+        MemoryBarrier();
+
+        readOffset = header->ReadOffset;
+
+        while (readOffset != writeOffset) {
+
+            position = readOffset & (Context->RingSize - 1);
+            pLogRecord = (PLOG_RECORD)(data + position);
+
+            //
+            //  A zero length means the writer skipped to the start of
+            //  the ring.
+            //
+
+            if (pLogRecord->Length == 0) {
+
+                readOffset += Context->RingSize - position;
+                continue;
+            }
+
+            if ((pLogRecord->Length < (sizeof(LOG_RECORD)+sizeof(WCHAR))) ||
+                (pLogRecord->Length > MAX_LOG_RECORD_LENGTH) ||
+                (pLogRecord->Length > Context->RingSize - position) ||
+                (pLogRecord->Length > writeOffset - readOffset)) {
+
+                printf( "UNEXPECTED LOG_RECORD->Length in ring %d: length=%d\n",
+                        index,
+                        pLogRecord->Length );
+
+                readOffset = writeOffset;
+                break;
+            }
+
+            found = TRUE;
+
+            //
+            //  Reparse point records are rewritten in place, so give them
+            //  a full sized buffer instead of the ring.
+            //
+
+            if (FlagOn(pLogRecord->RecordType,RECORD_TYPE_FILETAG)) {
+
+                CopyMemory( alignedRecord, pLogRecord, pLogRecord->Length );
+                ZeroMemory( (PUCHAR)alignedRecord + pLogRecord->Length,
+                            sizeof( alignedRecord ) - pLogRecord->Length );
+
+                readOffset += pLogRecord->Length;
+                DumpLogRecord( Context, (PLOG_RECORD)alignedRecord );
+
+            } else {
+
+                readOffset += pLogRecord->Length;
+                DumpLogRecord( Context, pLogRecord );
+            }
+        }
+
+        //
+        //  Give the space back only once we are done reading from it.
+        //
+
+        MemoryBarrier();
+        header->ReadOffset = readOffset;
+
+        dropped = header->DroppedRecords;
+
+        if (dropped != Context->LastDropped[index]) {
+
+            if (Context->LogToScreen) {
+
+                printf( "M:  Ring %d full, %d records dropped\n",
+                        index,
+                        dropped - Context->LastDropped[index] );
+            }
+
+            if (Context->LogToFile) {
+
+                fprintf( Context->OutputFile,
+                         "M:\tRing %d full\t%d records dropped\n",
+                         index,
+                         dropped - Context->LastDropped[index] );
+            }
+
+            Context->LastDropped[index] = dropped;
+        }
+    }
+
+    return found;
+}
+
+
 DWORD
 WINAPI
 RetrieveLogRecords(
@@ -104,6 +387,11 @@ Routine Description:
     This runs as a separate thread.  Its job is to retrieve log records
     from the filter and then output them
 
+    If the filter can map its shared log rings into this process we read
+    records straight from them, and only ask for the queued log when the
+    rings are empty.  That picks up anything queued before the rings were
+    mapped.
+
 Arguments:
 
     lpParameter - Contains context structure for synchronizing with the
@@ -122,11 +410,12 @@ Return Value:
     PCHAR buffer = (PCHAR) alignedBuffer;
     HRESULT hResult;
     PLOG_RECORD pLogRecord;
-    PRECORD_DATA pRecordData;
     COMMAND_MESSAGE commandMessage;
 
     //printf("Log: Starting up\n");
 
+    MapSharedLog( context );
+
 #pragma warning(push)
 #pragma warning(disable:4127) // conditional expression is constant
 
@@ -143,6 +432,15 @@ Return Value:
             break;
         }
 
+        //
+        //  Read from the shared log, if mapped, until it is empty.
+        //
+
+        if ((context->SharedLog != NULL) && DrainSharedLog( context )) {
+
+            continue;
+        }
+
         //
         //  Request log data from MiniSpy.
         //
@@ -215,76 +513,7 @@ Return Value:
                 break;
             }
 
-            pRecordData = &pLogRecord->Data;
-
-            //
-            //  See if a reparse point entry
-            //
-
-            if (FlagOn(pLogRecord->RecordType,RECORD_TYPE_FILETAG)) {
-
-                if (!TranslateFileTag( pLogRecord )){
-
-                    //
-                    // If this is a reparse point that can't be interpreted, move on.
-                    //
-
-                    pLogRecord = (PLOG_RECORD)Add2Ptr(pLogRecord,pLogRecord->Length);
-                    continue;
-                }
-            }
-
-            if (context->LogToScreen) {
-
-                ScreenDump( pLogRecord->SequenceNumber,
-                            pLogRecord->Name,
-                            pRecordData );
-            }
-
-            if (context->LogToFile) {
-
-                FileDump( pLogRecord->SequenceNumber,
-                          pLogRecord->Name,
-                          pRecordData,
-                          context->OutputFile );
-            }
-
-            //
-            //  The RecordType could also designate that we are out of memory
-            //  or hit our program defined memory limit, so check for these
-            //  cases.
-            //
-
-            if (FlagOn(pLogRecord->RecordType,RECORD_TYPE_FLAG_OUT_OF_MEMORY)) {
-
-                if (context->LogToScreen) {
-
-                    printf( "M:  %08X System Out of Memory\n",
-                            pLogRecord->SequenceNumber );
-                }
-
-                if (context->LogToFile) {
-
-                    fprintf( context->OutputFile,
-                             "M:\t0x%08X\tSystem Out of Memory\n",
-                             pLogRecord->SequenceNumber );
-                }
-
-            } else if (FlagOn(pLogRecord->RecordType,RECORD_TYPE_FLAG_EXCEED_MEMORY_ALLOWANCE)) {
-
-                if (context->LogToScreen) {
-
-                    printf( "M:  %08X Exceeded Mamimum Allowed Memory Buffers\n",
-                            pLogRecord->SequenceNumber );
-                }
-
-                if (context->LogToFile) {
-
-                    fprintf( context->OutputFile,
-                             "M:\t0x%08X\tExceeded Mamimum Allowed Memory Buffers\n",
-                             pLogRecord->SequenceNumber );
-                }
-            }
+            DumpLogRecord( context, pLogRecord );
 
             //
             // Move to next LOG_RECORD
@@ -45,6 +45,16 @@ typedef struct _LOG_CONTEXT {
     BOOLEAN CleaningUp;
     HANDLE  ShutDown;
 
+    //
+    //  The filter's shared log rings, if it mapped them for us.
+    //
+
+    PUCHAR SharedLog;
+    ULONG RingCount;
+    ULONG RingSize;
+    ULONG RingStride;
+    ULONG LastDropped[MINISPY_MAX_RINGS];
+
 } LOG_CONTEXT, *PLOG_CONTEXT;
 
 //
@@ -230,6 +230,7 @@ Return Value:
     context.LogToScreen = FALSE;        //don't start logging yet
     context.NextLogToScreen = TRUE;
     context.OutputFile = NULL;
+    context.SharedLog = NULL;
 
     if (context.ShutDown == NULL) {
 
@@ -466,6 +467,9 @@ Return Value:
     DWORD bufferLength;
     PWCHAR instanceString;
     WCHAR instanceName[INSTANCE_NAME_MAX_CHARS + 1];
+    MINISPY_FILTER filter;
+    PVOID alignedMessage[(FIELD_OFFSET( COMMAND_MESSAGE, Data ) + sizeof( MINISPY_FILTER ) + sizeof( PVOID ) - 1) / sizeof( PVOID )];
+    PCOMMAND_MESSAGE commandMessage = (PCOMMAND_MESSAGE) alignedMessage;
 
     //
     // Interpret the command line parameters
@@ -709,6 +713,129 @@ Return Value:
                 }
                 break;
 
+            case 'x':
+            case 'X':
+
+                //
+                // Set the kernel side filter from the keyword/value pairs
+                // that follow, or clear it if there are none.
+                //
+
+                ZeroMemory( &filter, sizeof( filter ) );
+
+                while ((parmIndex + 1 < argc) && (argv[parmIndex + 1][0] != '/')) {
+
+                    parmIndex++;
+                    parm = argv[parmIndex];
+
+                    parmIndex++;
+
+                    if (parmIndex >= argc) {
+
+                        //
+                        // Not enough parameters
+                        //
+
+                        goto InterpretCommand_Usage;
+                    }
+
+                    if (!_stricmp( parm, "major" )) {
+
+                        PCHAR next = argv[parmIndex];
+                        ULONG majorFunction;
+
+                        //
+                        // A comma separated list of major function codes
+                        //
+
+                        do {
+
+                            majorFunction = strtoul( next, &next, 0 );
+
+                            if (majorFunction > MAXUCHAR) {
+
+                                goto InterpretCommand_Usage;
+                            }
+
+                            filter.MajorFunctions[majorFunction / 32] |= 1 << (majorFunction % 32);
+
+                        } while (*next++ == ',');
+
+                        filter.Flags |= MINISPY_FILTER_MAJOR_FUNCTION;
+
+                    } else if (!_stricmp( parm, "pid" )) {
+
+                        filter.ProcessId = strtoul( argv[parmIndex], NULL, 0 );
+                        filter.Flags |= MINISPY_FILTER_PROCESS_ID;
+
+                    } else if (!_stricmp( parm, "path" )) {
+
+                        bufferLength = MultiByteToWideChar( CP_ACP,
+                                                            MB_ERR_INVALID_CHARS,
+                                                            argv[parmIndex],
+                                                            -1,
+                                                            filter.PathPrefix,
+                                                            MINISPY_FILTER_MAX_PREFIX_CHARS );
+
+                        if (bufferLength <= 1) {
+
+                            goto InterpretCommand_Usage;
+                        }
+
+                        filter.PathPrefixLength = (USHORT)((bufferLength - 1) * sizeof( WCHAR ));
+                        filter.Flags |= MINISPY_FILTER_PATH_PREFIX;
+
+                    } else if (!_stricmp( parm, "latency" )) {
+
+                        //
+                        // Given in microseconds, the filter wants 100ns
+                        //
+
+                        filter.MinLatency = strtoul( argv[parmIndex], NULL, 0 ) * 10;
+                        filter.Flags |= MINISPY_FILTER_MIN_LATENCY;
+
+                    } else if (!_stricmp( parm, "sample" )) {
+
+                        filter.SampleRate = strtoul( argv[parmIndex], NULL, 0 );
+
+                        if (filter.SampleRate == 0) {
+
+                            goto InterpretCommand_Usage;
+                        }
+
+                        filter.Flags |= MINISPY_FILTER_SAMPLE;
+
+                    } else {
+
+                        goto InterpretCommand_Usage;
+                    }
+                }
+
+                commandMessage->Command = SetMiniSpyFilter;
+                CopyMemory( commandMessage->Data, &filter, sizeof( filter ) );
+
+                hResult = FilterSendMessage( Context->Port,
+                                             commandMessage,
+                                             FIELD_OFFSET( COMMAND_MESSAGE, Data ) + sizeof( filter ),
+                                             NULL,
+                                             0,
+                                             &bufferLength );
+
+                if (IS_ERROR( hResult )) {
+
+                    printf( "    Could not set filter: 0x%08x\n", hResult );
+                    DisplayError( hResult );
+
+                } else if (filter.Flags == 0) {
+
+                    printf( "    Filter cleared\n" );
+
+                } else {
+
+                    printf( "    Filter set\n" );
+                }
+                break;
+
             default:
 
                 //
@@ -762,12 +889,15 @@ InterpretCommand_Exit:
     return returnValue;
 
 InterpretCommand_Usage:
-    printf("Valid switches: [/a <drive>] [/d <drive>] [/l] [/s] [/f [<file name>]]\n"
+    printf("Valid switches: [/a <drive>] [/d <drive>] [/l] [/s] [/f [<file name>]] [/x ...]\n"
            "    [/a <drive>] starts monitoring <drive>\n"
            "    [/d <drive> [<instance id>]] detaches filter <instance id> from <drive>\n"
            "    [/l] lists all the drives the monitor is currently attached to\n"
            "    [/s] turns on and off showing logging output on the screen\n"
            "    [/f [<file name>]] turns on and off logging to the specified file\n"
+           "    [/x [major <code>[,<code>...]] [pid <id>] [path <prefix>] [latency <us>] [sample <n>]]\n"
+           "        only logs operations matching all of the given conditions, sampling\n"
+           "        1 in <n> of them; /x alone logs everything again\n"
            "  If you are in command mode:\n"
            "    [enter] will enter command mode\n"
            "    [go|g] will exit command mode\n"
@@ -39,6 +39,43 @@ ULONG gTraceFlags = 0;
         DbgPrint _string :                          \
         ((int)0))
 
+#if defined(PT_CALLBACK_TIMING)
+
+//
+//  Callback timing.  When the filter is built with PT_CALLBACK_TIMING
+//  defined, the pass through callbacks measure how long they run with the
+//  performance counter and accumulate the result per IRP major function.
+//  Each processor has its own set of accumulators so that the measurement
+//  does not add cache line contention to the cost it is measuring.  The
+//  totals are printed to the debugger when the filter unloads.
+//
+//  Major functions are indexed as a UCHAR so that the FltMgr specific
+//  operations, which have negative major function codes, fit as well.
+//
+
+#define PT_TIMING_TAG                   'mTtP'
+#define PT_TIMING_MAJOR_COUNT           256
+
+typedef struct _PT_CALLBACK_TIME {
+
+    LONG64 Count;
+    LONG64 Ticks;
+
+} PT_CALLBACK_TIME, *PPT_CALLBACK_TIME;
+
+typedef struct _PT_PROCESSOR_TIMES {
+
+    PT_CALLBACK_TIME PreOperation[PT_TIMING_MAJOR_COUNT];
+    PT_CALLBACK_TIME PostOperation[PT_TIMING_MAJOR_COUNT];
+
+} PT_PROCESSOR_TIMES, *PPT_PROCESSOR_TIMES;
+
+PPT_PROCESSOR_TIMES gProcessorTimes;
+ULONG gProcessorCount;
+LARGE_INTEGER gTimingFrequency;
+
+#endif
+
 /*************************************************************************
     Prototypes
 *************************************************************************/
@@ -116,6 +153,22 @@ PtDoRequestOperationStatus(
     _In_ PFLT_CALLBACK_DATA Data
     );
 
+#if defined(PT_CALLBACK_TIMING)
+
+VOID
+PtTimingRecord (
+    _In_ BOOLEAN PostOperation,
+    _In_ UCHAR MajorFunction,
+    _In_ LONG64 StartTime
+    );
+
+VOID
+PtTimingReport (
+    VOID
+    );
+
+#endif
+
 //
 //  Assign text sections for each routine.
 //
@@ -127,6 +180,9 @@ PtDoRequestOperationStatus(
 #pragma alloc_text(PAGE, PtInstanceSetup)
 #pragma alloc_text(PAGE, PtInstanceTeardownStart)
 #pragma alloc_text(PAGE, PtInstanceTeardownComplete)
+#if defined(PT_CALLBACK_TIMING)
+#pragma alloc_text(PAGE, PtTimingReport)
+#endif
 #endif
 
 //
@@ -552,6 +608,29 @@ Return Value:
     PT_DBG_PRINT( PTDBG_TRACE_ROUTINES,
                   ("PassThrough!DriverEntry: Entered\n") );
 
+#if defined(PT_CALLBACK_TIMING)
+
+    //
+    //  Allocate the timing accumulators for every processor that can ever
+    //  be present so that the callbacks never have to check for hot added
+    //  processors.
+    //
+
+    gProcessorCount = KeQueryMaximumProcessorCountEx( ALL_PROCESSOR_GROUPS );
+    gProcessorTimes = ExAllocatePoolWithTag( NonPagedPool,
+                                             gProcessorCount * sizeof( PT_PROCESSOR_TIMES ),
+                                             PT_TIMING_TAG );
+
+    if (gProcessorTimes == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory( gProcessorTimes, gProcessorCount * sizeof( PT_PROCESSOR_TIMES ) );
+    KeQueryPerformanceCounter( &gTimingFrequency );
+
+#endif
+
     //
     //  Register with FltMgr to tell it our callback routines
     //
@@ -576,6 +655,16 @@ Return Value:
         }
     }
 
+#if defined(PT_CALLBACK_TIMING)
+
+    if (!NT_SUCCESS( status )) {
+
+        ExFreePoolWithTag( gProcessorTimes, PT_TIMING_TAG );
+        gProcessorTimes = NULL;
+    }
+
+#endif
+
     return status;
 }
 
@@ -611,6 +700,19 @@ Return Value:
 
     FltUnregisterFilter( gFilterHandle );
 
+#if defined(PT_CALLBACK_TIMING)
+
+    //
+    //  No callback can be running once the filter is unregistered, so the
+    //  accumulators are final.
+    //
+
+    PtTimingReport();
+    ExFreePoolWithTag( gProcessorTimes, PT_TIMING_TAG );
+    gProcessorTimes = NULL;
+
+#endif
+
     return STATUS_SUCCESS;
 }
 
@@ -654,6 +756,9 @@ Return Value:
 --*/
 {
     NTSTATUS status;
+#if defined(PT_CALLBACK_TIMING)
+    LONG64 startTime = KeQueryPerformanceCounter( NULL ).QuadPart;
+#endif
 
     UNREFERENCED_PARAMETER( FltObjects );
     UNREFERENCED_PARAMETER( CompletionContext );
@@ -683,6 +788,10 @@ Return Value:
         }
     }
 
+#if defined(PT_CALLBACK_TIMING)
+    PtTimingRecord( FALSE, Data->Iopb->MajorFunction, startTime );
+#endif
+
     return FLT_PREOP_SUCCESS_WITH_CALLBACK;
 }
 
@@ -777,6 +886,10 @@ Return Value:
 
 --*/
 {
+#if defined(PT_CALLBACK_TIMING)
+    LONG64 startTime = KeQueryPerformanceCounter( NULL ).QuadPart;
+#endif
+
     UNREFERENCED_PARAMETER( Data );
     UNREFERENCED_PARAMETER( FltObjects );
     UNREFERENCED_PARAMETER( CompletionContext );
@@ -785,6 +898,10 @@ Return Value:
     PT_DBG_PRINT( PTDBG_TRACE_ROUTINES,
                   ("PassThrough!PtPostOperationPassThrough: Entered\n") );
 
+#if defined(PT_CALLBACK_TIMING)
+    PtTimingRecord( TRUE, Data->Iopb->MajorFunction, startTime );
+#endif
+
     return FLT_POSTOP_FINISHED_PROCESSING;
 }
 
@@ -824,6 +941,10 @@ Return Value:
 
 --*/
 {
+#if defined(PT_CALLBACK_TIMING)
+    LONG64 startTime = KeQueryPerformanceCounter( NULL ).QuadPart;
+#endif
+
     UNREFERENCED_PARAMETER( Data );
     UNREFERENCED_PARAMETER( FltObjects );
     UNREFERENCED_PARAMETER( CompletionContext );
@@ -831,6 +952,10 @@ Return Value:
     PT_DBG_PRINT( PTDBG_TRACE_ROUTINES,
                   ("PassThrough!PtPreOperationNoPostOperationPassThrough: Entered\n") );
 
+#if defined(PT_CALLBACK_TIMING)
+    PtTimingRecord( FALSE, Data->Iopb->MajorFunction, startTime );
+#endif
+
     return FLT_PREOP_SUCCESS_NO_CALLBACK;
 }
 
@@ -885,3 +1010,131 @@ Return Value:
              );
 }
 
+
+#if defined(PT_CALLBACK_TIMING)
+
+VOID
+PtTimingRecord (
+    _In_ BOOLEAN PostOperation,
+    _In_ UCHAR MajorFunction,
+    _In_ LONG64 StartTime
+    )
+/*++
+
+Routine Description:
+
+    This adds the time spent in a callback to the accumulators of the
+    current processor.
+
+    The thread may have been rescheduled to another processor since the
+    callback started, and another thread may update the same accumulators
+    on this processor, so the updates are still interlocked.  They only
+    ever touch a cache line owned by this processor though, so they stay
+    cheap.
+
+    This is non-pageable because it is called from the post-operation
+    callback, which may run at DPC level.
+
+Arguments:
+
+    PostOperation - TRUE if the time was spent in a post-operation callback.
+
+    MajorFunction - The major function of the operation.
+
+    StartTime - The performance counter value when the callback started.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    ULONG processor;
+    PPT_CALLBACK_TIME time;
+
+    processor = KeGetCurrentProcessorNumberEx( NULL );
+
+    if (processor >= gProcessorCount) {
+
+        processor = processor % gProcessorCount;
+    }
+
+    if (PostOperation) {
+
+        time = &gProcessorTimes[processor].PostOperation[MajorFunction];
+
+    } else {
+
+        time = &gProcessorTimes[processor].PreOperation[MajorFunction];
+    }
+
+    InterlockedAdd64( &time->Ticks,
+                      KeQueryPerformanceCounter( NULL ).QuadPart - StartTime );
+    InterlockedIncrement64( &time->Count );
+}
+
+
+VOID
+PtTimingReport (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    This sums the accumulators of all processors and prints the number of
+    calls and the average time per call, in nanoseconds, of the pre and
+    post-operation callbacks of every major function that was seen.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    ULONG major;
+    ULONG processor;
+    PT_CALLBACK_TIME pre;
+    PT_CALLBACK_TIME post;
+
+    PAGED_CODE();
+
+    DbgPrint( "PassThrough!PtTimingReport: callback time per call (ns)\n" );
+
+    for (major = 0; major < PT_TIMING_MAJOR_COUNT; major++) {
+
+        RtlZeroMemory( &pre, sizeof( pre ) );
+        RtlZeroMemory( &post, sizeof( post ) );
+
+        for (processor = 0; processor < gProcessorCount; processor++) {
+
+            pre.Count += gProcessorTimes[processor].PreOperation[major].Count;
+            pre.Ticks += gProcessorTimes[processor].PreOperation[major].Ticks;
+            post.Count += gProcessorTimes[processor].PostOperation[major].Count;
+            post.Ticks += gProcessorTimes[processor].PostOperation[major].Ticks;
+        }
+
+        if ((pre.Count == 0) && (post.Count == 0)) {
+
+            continue;
+        }
+
+        //
+        //  Average in thousandths of a tick first so that a short callback
+        //  on a slow performance counter does not round down to zero.
+        //
+
+        DbgPrint( "    %-44s pre %10I64d calls %8I64d ns, post %10I64d calls %8I64d ns\n",
+                  FltGetIrpName( (UCHAR)major ),
+                  pre.Count,
+                  (pre.Count == 0) ? 0 : ((pre.Ticks * 1000) / pre.Count) * 1000000 / gTimingFrequency.QuadPart,
+                  post.Count,
+                  (post.Count == 0) ? 0 : ((post.Ticks * 1000) / post.Count) * 1000000 / gTimingFrequency.QuadPart );
+    }
+}
+
+#endif
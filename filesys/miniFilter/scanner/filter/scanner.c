@@ -50,6 +50,14 @@ ULONG ScannedExtensionCount;
 
 UNICODE_STRING ScannedExtensionDefault = RTL_CONSTANT_STRING( L"doc" );
 
+//
+//  Random values mixed into the rolling hash that finds chunk boundaries.
+//  They are generated from a fixed seed so that a file splits into the
+//  same chunks every time the driver loads.
+//
+
+ULONGLONG ScannerGearTable[256];
+
 //
 //  Function prototypes
 //
@@ -94,6 +102,26 @@ ScannerpScanFileInUserMode (
     _Out_ PBOOLEAN SafeToOpen
     );
 
+VOID
+ScannerpInitializeGearTable (
+    VOID
+    );
+
+ULONG
+ScannerpFindChunkBoundary (
+    _In_reads_bytes_(Length) PUCHAR Data,
+    _In_ ULONG Length,
+    _In_ BOOLEAN AtEnd
+    );
+
+NTSTATUS
+ScannerpScanChunks (
+    _In_ PUCHAR Window,
+    _In_ PSCANNER_CHUNK_BATCH Batch,
+    _Inout_ PSCANNER_NOTIFICATION Notification,
+    _Out_ PBOOLEAN SafeToOpen
+    );
+
 BOOLEAN
 ScannerpCheckExtension (
     _In_ PUNICODE_STRING Extension
@@ -106,6 +134,7 @@ ScannerpCheckExtension (
 #ifdef ALLOC_PRAGMA
     #pragma alloc_text(INIT, DriverEntry)
     #pragma alloc_text(INIT, ScannerInitializeScannedExtensions)    
+    #pragma alloc_text(INIT, ScannerpInitializeGearTable)
     #pragma alloc_text(PAGE, ScannerInstanceSetup)
     #pragma alloc_text(PAGE, ScannerPreCreate)
     #pragma alloc_text(PAGE, ScannerPortConnect)
@@ -224,6 +253,8 @@ Return Value:
     
     ExInitializeDriverRuntime( DrvRtPoolNxOptIn );
 
+    ScannerpInitializeGearTable();
+
     //
     //  Register with filter manager.
     //
@@ -1205,7 +1236,9 @@ Return Value:
     NTSTATUS status;
     PSCANNER_NOTIFICATION notification = NULL;
     PSCANNER_STREAM_HANDLE_CONTEXT context = NULL;
+    SCANNER_REPLY reply;
     ULONG replyLength;
+    ULONG length;
     BOOLEAN safe = TRUE;
     PUCHAR buffer;
 
@@ -1283,8 +1316,10 @@ Return Value:
             //  This is just a sample!
             //
 
+            length = min( Data->Iopb->Parameters.Write.Length, SCANNER_READ_BUFFER_SIZE );
+
             notification = ExAllocatePoolWithTag( NonPagedPool,
-                                                  sizeof( SCANNER_NOTIFICATION ),
+                                                  FIELD_OFFSET( SCANNER_NOTIFICATION, Contents ) + length,
                                                   'nacS' );
             if (notification == NULL) {
 
@@ -1294,7 +1329,15 @@ Return Value:
                 leave;
             }
 
-            notification->BytesToScan = min( Data->Iopb->Parameters.Write.Length, SCANNER_READ_BUFFER_SIZE );
+            //
+            //  The data written does not line up with the chunks of the file,
+            //  so it is scanned without a chunk user mode could remember.
+            //
+
+            notification->Type = ScannerMessageScanData;
+            notification->BytesToScan = length;
+            notification->ChunkCount = 0;
+            notification->Reserved = 0;
 
             //
             //  The buffer can be a raw user buffer. Protect access to it
@@ -1329,14 +1372,14 @@ Return Value:
             status = FltSendMessage( ScannerData.Filter,
                                      &ScannerData.ClientPort,
                                      notification,
-                                     sizeof( SCANNER_NOTIFICATION ),
-                                     notification,
+                                     FIELD_OFFSET( SCANNER_NOTIFICATION, Contents ) + length,
+                                     &reply,
                                      &replyLength,
                                      NULL );
 
             if (STATUS_SUCCESS == status) {
 
-               safe = ((PSCANNER_REPLY) notification)->SafeToOpen;
+               safe = reply.SafeToOpen;
 
            } else {
 
@@ -1506,6 +1549,12 @@ Routine Description:
     This routine is called to send a request up to user mode to scan a given
     file and tell our caller whether it's safe to open this file.
 
+    The file is split into content-defined chunks. For each batch of chunks
+    we first send only their hashes, and then the contents of the chunks
+    user mode does not already know to be clean. Rescanning a file after a
+    small change therefore transfers and scans little more than the chunks
+    around the change.
+
     Note that if the scan fails, we set SafeToOpen to TRUE.  The scan may fail
     because the service hasn't started, or perhaps because this create/cleanup
     is for a directory, and there's no data to read & scan.
@@ -1532,12 +1581,19 @@ Return Value:
 {
     NTSTATUS status = STATUS_SUCCESS;
     PVOID buffer = NULL;
+    PUCHAR window = NULL;
+    PSCANNER_CHUNK_BATCH batch = NULL;
     ULONG bytesRead;
     PSCANNER_NOTIFICATION notification = NULL;
     FLT_VOLUME_PROPERTIES volumeProps;
     LARGE_INTEGER offset;
-    ULONG replyLength, length;
+    ULONG length;
     PFLT_VOLUME volume = NULL;
+    ULONG windowLength = 0;
+    ULONG chunkStart = 0;
+    ULONG chunkLength;
+    ULONG hashStart;
+    BOOLEAN atEnd = FALSE;
 
     *SafeToOpen = TRUE;
 
@@ -1583,7 +1639,11 @@ Return Value:
             leave;
         }
 
-        length = max( SCANNER_READ_BUFFER_SIZE, volumeProps.SectorSize );
+        //
+        //  Both are powers of two, so this is a multiple of the sector size.
+        //
+
+        length = max( SCANNER_FILE_READ_LENGTH, volumeProps.SectorSize );
 
         //
         //  Use non-buffered i/o, so allocate aligned pool
@@ -1600,6 +1660,26 @@ Return Value:
             leave;
         }
 
+        window = ExAllocatePoolWithTag( PagedPool,
+                                        SCANNER_FILE_WINDOW_SIZE + length,
+                                        'nacS' );
+
+        if (NULL == window) {
+
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            leave;
+        }
+
+        batch = ExAllocatePoolWithTag( PagedPool,
+                                       sizeof( SCANNER_CHUNK_BATCH ),
+                                       'nacS' );
+
+        if (NULL == batch) {
+
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            leave;
+        }
+
         notification = ExAllocatePoolWithTag( NonPagedPool,
                                               sizeof( SCANNER_NOTIFICATION ),
                                               'nacS' );
@@ -1610,56 +1690,113 @@ Return Value:
             leave;
         }
 
-        //
-        //  Read the beginning of the file and pass the contents to user mode.
-        //
+        offset.QuadPart = 0;
 
-        offset.QuadPart = bytesRead = 0;
-        status = FltReadFile( Instance,
-                              FileObject,
-                              &offset,
-                              length,
-                              buffer,
-                              FLTFL_IO_OPERATION_NON_CACHED |
-                              FLTFL_IO_OPERATION_DO_NOT_UPDATE_BYTE_OFFSET,
-                              &bytesRead,
-                              NULL,
-                              NULL );
+        for (;;) {
+
+            //
+            //  Fill the window. Once it is full it holds more than a maximum
+            //  length chunk past chunkStart, so the next chunk can be found.
+            //
+
+            while (!atEnd && (windowLength <= SCANNER_FILE_WINDOW_SIZE)) {
+
+                bytesRead = 0;
+                status = FltReadFile( Instance,
+                                      FileObject,
+                                      &offset,
+                                      length,
+                                      buffer,
+                                      FLTFL_IO_OPERATION_NON_CACHED |
+                                      FLTFL_IO_OPERATION_DO_NOT_UPDATE_BYTE_OFFSET,
+                                      &bytesRead,
+                                      NULL,
+                                      NULL );
 
-        if (NT_SUCCESS( status ) && (0 != bytesRead)) {
+                if (status == STATUS_END_OF_FILE) {
+
+                    status = STATUS_SUCCESS;
+                    bytesRead = 0;
+                }
+
+                if (!NT_SUCCESS( status )) {
+
+                    leave;
+                }
 
-            notification->BytesToScan = (ULONG) bytesRead;
+                RtlCopyMemory( window + windowLength, buffer, bytesRead );
+                windowLength += bytesRead;
+                offset.QuadPart += bytesRead;
+
+                if ((bytesRead < length) ||
+                    (offset.QuadPart >= SCANNER_MAX_SCAN_LENGTH)) {
+
+                    atEnd = TRUE;
+                }
+            }
 
             //
-            //  Copy only as much as the buffer can hold
+            //  Split the window into chunks. Each is hashed together with
+            //  the overlap preceding it.
             //
 
-            RtlCopyMemory( &notification->Contents,
-                           buffer,
-                           min( notification->BytesToScan, SCANNER_READ_BUFFER_SIZE ) );
+            batch->Count = 0;
 
-            replyLength = sizeof( SCANNER_REPLY );
+            while (batch->Count < SCANNER_MAX_CHUNKS) {
 
-            status = FltSendMessage( ScannerData.Filter,
-                                     &ScannerData.ClientPort,
-                                     notification,
-                                     sizeof(SCANNER_NOTIFICATION),
-                                     notification,
-                                     &replyLength,
-                                     NULL );
+                chunkLength = ScannerpFindChunkBoundary( window + chunkStart,
+                                                         windowLength - chunkStart,
+                                                         atEnd );
 
-            if (STATUS_SUCCESS == status) {
+                if (chunkLength == 0) {
 
-                *SafeToOpen = ((PSCANNER_REPLY) notification)->SafeToOpen;
+                    break;
+                }
 
-            } else {
+                hashStart = chunkStart - min( chunkStart, SCANNER_CHUNK_OVERLAP );
 
-                //
-                //  Couldn't send message
-                //
+                batch->Start[batch->Count] = hashStart;
+                batch->Chunks[batch->Count].Length = chunkStart + chunkLength - hashStart;
+                batch->Chunks[batch->Count].Hash = ScannerHashChunk( window + hashStart,
+                                                                     batch->Chunks[batch->Count].Length );
+                batch->Chunks[batch->Count].Reserved = 0;
+                batch->Count += 1;
+
+                chunkStart += chunkLength;
+            }
+
+            //
+            //  No chunk is only found once everything read has been scanned.
+            //
+
+            if (batch->Count == 0) {
+
+                break;
+            }
 
-                DbgPrint( "!!! scanner.sys --- couldn't send message to user-mode to scan file, status 0x%X\n", status );
+            status = ScannerpScanChunks( window,
+                                         batch,
+                                         notification,
+                                         SafeToOpen );
+
+            if (!NT_SUCCESS( status ) || !*SafeToOpen) {
+
+                leave;
             }
+
+            //
+            //  Drop the scanned chunks from the window, keeping the overlap
+            //  the next chunk is hashed with.
+            //
+
+            hashStart = chunkStart - min( chunkStart, SCANNER_CHUNK_OVERLAP );
+
+            RtlMoveMemory( window,
+                           window + hashStart,
+                           windowLength - hashStart );
+
+            windowLength -= hashStart;
+            chunkStart -= hashStart;
         }
 
     } finally {
@@ -1669,6 +1806,16 @@ Return Value:
             FltFreePoolAlignedWithTag( Instance, buffer, 'nacS' );
         }
 
+        if (NULL != window) {
+
+            ExFreePoolWithTag( window, 'nacS' );
+        }
+
+        if (NULL != batch) {
+
+            ExFreePoolWithTag( batch, 'nacS' );
+        }
+
         if (NULL != notification) {
 
             ExFreePoolWithTag( notification, 'nacS' );
@@ -1683,3 +1830,200 @@ Return Value:
     return status;
 }
 
+
+NTSTATUS
+ScannerpScanChunks (
+    _In_ PUCHAR Window,
+    _In_ PSCANNER_CHUNK_BATCH Batch,
+    _Inout_ PSCANNER_NOTIFICATION Notification,
+    _Out_ PBOOLEAN SafeToOpen
+    )
+/*++
+
+Routine Description:
+
+    This routine sends the hashes of a batch of chunks to user mode, and then
+    the contents of each chunk user mode asks for, until one of them is
+    found to be foul.
+
+Arguments:
+
+    Window - The file contents the batch describes.
+
+    Batch - The chunks to be scanned.
+
+    Notification - Buffer to build the messages in.
+
+    SafeToOpen - Set to FALSE if a chunk contains foul language.
+
+Return Value:
+
+    The status of the operation.
+
+--*/
+{
+    NTSTATUS status;
+    SCANNER_REPLY reply;
+    ULONG replyLength;
+    ULONGLONG neededChunks;
+    ULONG i;
+
+    *SafeToOpen = TRUE;
+
+    Notification->Type = ScannerMessageChunkHashes;
+    Notification->BytesToScan = 0;
+    Notification->ChunkCount = Batch->Count;
+    Notification->Reserved = 0;
+
+    RtlCopyMemory( Notification->Chunks,
+                   Batch->Chunks,
+                   Batch->Count * sizeof( SCANNER_CHUNK ) );
+
+    replyLength = sizeof( SCANNER_REPLY );
+
+    status = FltSendMessage( ScannerData.Filter,
+                             &ScannerData.ClientPort,
+                             Notification,
+                             FIELD_OFFSET( SCANNER_NOTIFICATION, Contents ),
+                             &reply,
+                             &replyLength,
+                             NULL );
+
+    if (STATUS_SUCCESS != status) {
+
+        DbgPrint( "!!! scanner.sys --- couldn't send message to user-mode to scan file, status 0x%X\n", status );
+        return status;
+    }
+
+    neededChunks = reply.NeededChunks;
+
+    for (i = 0; (i < Batch->Count) && (neededChunks != 0); i += 1) {
+
+        if ((neededChunks & (1ULL << i)) == 0) {
+
+            continue;
+        }
+
+        neededChunks &= ~(1ULL << i);
+
+        Notification->Type = ScannerMessageScanData;
+        Notification->BytesToScan = Batch->Chunks[i].Length;
+        Notification->ChunkCount = 1;
+        Notification->Chunks[0] = Batch->Chunks[i];
+
+        RtlCopyMemory( &Notification->Contents,
+                       Window + Batch->Start[i],
+                       Notification->BytesToScan );
+
+        replyLength = sizeof( SCANNER_REPLY );
+
+        status = FltSendMessage( ScannerData.Filter,
+                                 &ScannerData.ClientPort,
+                                 Notification,
+                                 FIELD_OFFSET( SCANNER_NOTIFICATION, Contents ) + Notification->BytesToScan,
+                                 &reply,
+                                 &replyLength,
+                                 NULL );
+
+        if (STATUS_SUCCESS != status) {
+
+            DbgPrint( "!!! scanner.sys --- couldn't send message to user-mode to scan file, status 0x%X\n", status );
+            return status;
+        }
+
+        if (!reply.SafeToOpen) {
+
+            *SafeToOpen = FALSE;
+            break;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+ULONG
+ScannerpFindChunkBoundary (
+    _In_reads_bytes_(Length) PUCHAR Data,
+    _In_ ULONG Length,
+    _In_ BOOLEAN AtEnd
+    )
+/*++
+
+Routine Description:
+
+    This routine finds where the chunk starting at Data ends.
+
+Arguments:
+
+    Data - The start of the chunk.
+
+    Length - The number of bytes available at Data.
+
+    AtEnd - TRUE if the file, or the part of it that is scanned, ends
+        after Length bytes.
+
+Return Value:
+
+    The length of the chunk, or 0 if more data is needed to find its end
+    or there is no data left.
+
+--*/
+{
+    ULONGLONG hash = 0;
+    ULONG limit = min( Length, SCANNER_CHUNK_MAX_SIZE );
+    ULONG i;
+
+    for (i = SCANNER_CHUNK_MIN_SIZE; i < limit; i += 1) {
+
+        hash = (hash << 1) + ScannerGearTable[Data[i]];
+
+        if ((hash & SCANNER_CHUNK_BOUNDARY_MASK) == 0) {
+
+            return i + 1;
+        }
+    }
+
+    if (Length >= SCANNER_CHUNK_MAX_SIZE) {
+
+        return SCANNER_CHUNK_MAX_SIZE;
+    }
+
+    return AtEnd ? Length : 0;
+}
+
+
+VOID
+ScannerpInitializeGearTable (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    This routine fills the gear table with pseudo random values (splitmix64).
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    ULONGLONG state = 0x5363616e6e657221ULL;
+    ULONGLONG value;
+    ULONG i;
+
+    for (i = 0; i < ARRAYSIZE( ScannerGearTable ); i += 1) {
+
+        state += 0x9e3779b97f4a7c15ULL;
+        value = state;
+        value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+        ScannerGearTable[i] = value ^ (value >> 31);
+    }
+}
+
@@ -81,6 +81,45 @@ typedef struct _SCANNER_CREATE_PARAMS {
 
 #pragma warning(pop)
 
+//
+//  Content-defined chunking parameters. A chunk ends after a byte where the
+//  top bits of the rolling gear hash are all clear, which on random data
+//  gives chunks about SCANNER_CHUNK_MIN_SIZE + 8KB long, and otherwise at
+//  SCANNER_CHUNK_MAX_SIZE (see scanuk.h). Since a boundary depends only on
+//  the 64 bytes before it, a write only moves the boundaries near it.
+//
+
+#define SCANNER_CHUNK_MIN_SIZE          2048
+#define SCANNER_CHUNK_BOUNDARY_MASK     0xFFF8000000000000ULL
+
+//
+//  The file is read in pieces of SCANNER_FILE_READ_LENGTH into a window of
+//  SCANNER_FILE_WINDOW_SIZE plus one read, and no more than
+//  SCANNER_MAX_SCAN_LENGTH bytes of it are scanned.
+//
+
+#define SCANNER_FILE_READ_LENGTH        (64 * 1024)
+#define SCANNER_FILE_WINDOW_SIZE        (256 * 1024)
+#define SCANNER_MAX_SCAN_LENGTH         (16 * 1024 * 1024)
+
+//
+//  The chunks of the window described by one ScannerMessageChunkHashes.
+//
+
+typedef struct _SCANNER_CHUNK_BATCH {
+
+    ULONG Count;
+
+    //
+    //  Window offset of the hashed contents of each chunk.
+    //
+
+    ULONG Start[SCANNER_MAX_CHUNKS];
+
+    SCANNER_CHUNK Chunks[SCANNER_MAX_CHUNKS];
+
+} SCANNER_CHUNK_BATCH, *PSCANNER_CHUNK_BATCH;
+
 
 ///////////////////////////////////////////////////////////////////////////
 //
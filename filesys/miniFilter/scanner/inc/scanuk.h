@@ -28,12 +28,61 @@ Environment:
 const PWSTR ScannerPortName = L"\\ScannerPort";
 
 
-#define SCANNER_READ_BUFFER_SIZE   1024
+//
+//  Files are scanned in content-defined chunks of at most this size, see
+//  ScannerpScanFileInUserMode. Each chunk is hashed and scanned together
+//  with the SCANNER_CHUNK_OVERLAP bytes that precede it, so that a string
+//  straddling a chunk boundary is still found. The overlap must be at
+//  least the length of the longest string scanned for, less one.
+//
+
+#define SCANNER_CHUNK_MAX_SIZE     16384
+#define SCANNER_CHUNK_OVERLAP      64
+
+#define SCANNER_READ_BUFFER_SIZE   (SCANNER_CHUNK_OVERLAP + SCANNER_CHUNK_MAX_SIZE)
+
+//
+//  The number of chunks described by one ScannerMessageChunkHashes, limited
+//  by the size of SCANNER_REPLY::NeededChunks.
+//
+
+#define SCANNER_MAX_CHUNKS         64
+
+typedef enum _SCANNER_MESSAGE_TYPE {
+
+    //
+    //  Contents holds BytesToScan bytes to be scanned. If ChunkCount is 1,
+    //  they are the chunk described by Chunks[0] and a clean verdict may be
+    //  remembered for it.
+    //
+
+    ScannerMessageScanData,
+
+    //
+    //  Chunks holds the hashes of the next ChunkCount chunks of a file. The
+    //  reply sets NeededChunks to the chunks not already known to be clean,
+    //  whose contents are then sent with ScannerMessageScanData.
+    //
+
+    ScannerMessageChunkHashes
+
+} SCANNER_MESSAGE_TYPE;
+
+typedef struct _SCANNER_CHUNK {
+
+    ULONGLONG Hash;
+    ULONG Length;               // bytes hashed, including the overlap
+    ULONG Reserved;
+
+} SCANNER_CHUNK, *PSCANNER_CHUNK;
 
 typedef struct _SCANNER_NOTIFICATION {
 
+    ULONG Type;                 // SCANNER_MESSAGE_TYPE
     ULONG BytesToScan;
-    ULONG Reserved;             // for quad-word alignement of the Contents structure
+    ULONG ChunkCount;
+    ULONG Reserved;             // for quad-word alignement of the Chunks structure
+    SCANNER_CHUNK Chunks[SCANNER_MAX_CHUNKS];
     UCHAR Contents[SCANNER_READ_BUFFER_SIZE];
     
 } SCANNER_NOTIFICATION, *PSCANNER_NOTIFICATION;
@@ -41,9 +90,41 @@ typedef struct _SCANNER_NOTIFICATION {
 typedef struct _SCANNER_REPLY {
 
     BOOLEAN SafeToOpen;
+
+    //
+    //  Bit n is set if the contents of Chunks[n] have to be sent.
+    //  Valid for ScannerMessageChunkHashes.
+    //
+
+    ULONGLONG NeededChunks;
     
 } SCANNER_REPLY, *PSCANNER_REPLY;
 
+//
+//  The hash identifying a chunk (64-bit FNV-1a). A production scanner would
+//  use a cryptographic hash instead, since a crafted collision with a clean
+//  chunk would keep the colliding contents from ever being scanned.
+//
+
+FORCEINLINE
+ULONGLONG
+ScannerHashChunk (
+    _In_reads_bytes_(Length) const UCHAR *Buffer,
+    _In_ ULONG Length
+    )
+{
+    ULONGLONG hash = 0xcbf29ce484222325ULL;
+    ULONG i;
+
+    for (i = 0; i < Length; i++) {
+
+        hash ^= Buffer[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
 #endif //  __SCANUK_H__
 
 
@@ -51,6 +51,26 @@ typedef struct _SCANNER_THREAD_CONTEXT {
 
 } SCANNER_THREAD_CONTEXT, *PSCANNER_THREAD_CONTEXT;
 
+//
+//  Chunks found to be clean, so that the filter does not have to send them
+//  again when a file is rescanned. A direct-mapped table indexed by the low
+//  bits of the chunk hash: a newer chunk simply replaces an older one.
+//  Since the same hashed bytes can't become foul later the verdicts never
+//  go stale; they would have to be dropped if FoulString could change.
+//
+
+#define SCANNER_CHUNK_CACHE_SIZE            65536   // a power of two
+
+typedef struct _SCANNER_CHUNK_CACHE_ENTRY {
+
+    ULONGLONG Hash;
+    ULONG Length;                                   // 0 if the entry is empty
+
+} SCANNER_CHUNK_CACHE_ENTRY, *PSCANNER_CHUNK_CACHE_ENTRY;
+
+SCANNER_CHUNK_CACHE_ENTRY ChunkCache[SCANNER_CHUNK_CACHE_SIZE];
+SRWLOCK ChunkCacheLock = SRWLOCK_INIT;
+
 
 VOID
 Usage (
@@ -127,6 +147,88 @@ Return Value
 }
 
 
+BOOL
+IsChunkClean (
+    _In_ PSCANNER_CHUNK Chunk
+    )
+/*++
+
+Routine Description
+
+    Looks up a chunk in the clean chunk cache.
+
+Arguments
+
+    Chunk       -   The hash and length of the chunk
+
+Return Value
+
+    TRUE        -    The chunk was scanned before and is clean
+    FALSE       -    The chunk has to be scanned
+
+--*/
+{
+    PSCANNER_CHUNK_CACHE_ENTRY entry;
+    BOOL clean;
+
+    entry = &ChunkCache[Chunk->Hash & (SCANNER_CHUNK_CACHE_SIZE - 1)];
+
+    AcquireSRWLockShared( &ChunkCacheLock );
+
+    clean = (entry->Length != 0) &&
+            (entry->Hash == Chunk->Hash) &&
+            (entry->Length == Chunk->Length);
+
+    ReleaseSRWLockShared( &ChunkCacheLock );
+
+    return clean;
+}
+
+
+VOID
+RememberCleanChunk (
+    _In_reads_bytes_(BufferSize) PUCHAR Buffer,
+    _In_ ULONG BufferSize
+    )
+/*++
+
+Routine Description
+
+    Adds a chunk that was scanned and found clean to the clean chunk cache.
+    The hash is computed over the data actually scanned rather than taken
+    from the message.
+
+Arguments
+
+    Buffer      -   Pointer to the chunk contents
+    BufferSize  -   Size of the chunk
+
+Return Value
+
+    None
+
+--*/
+{
+    PSCANNER_CHUNK_CACHE_ENTRY entry;
+    ULONGLONG hash;
+
+    if (BufferSize == 0) {
+
+        return;
+    }
+
+    hash = ScannerHashChunk( Buffer, BufferSize );
+    entry = &ChunkCache[hash & (SCANNER_CHUNK_CACHE_SIZE - 1)];
+
+    AcquireSRWLockExclusive( &ChunkCacheLock );
+
+    entry->Hash = hash;
+    entry->Length = BufferSize;
+
+    ReleaseSRWLockExclusive( &ChunkCacheLock );
+}
+
+
 DWORD
 ScannerWorker(
     _In_ PSCANNER_THREAD_CONTEXT Context
@@ -157,6 +259,7 @@ Return Value
     DWORD outSize;
     HRESULT hr;
     ULONG_PTR key;
+    ULONG i, known;
 
 #pragma warning(push)
 #pragma warning(disable:4127) // conditional expression is constant
@@ -194,20 +297,58 @@ Return Value
 
         notification = &message->Notification;
 
-        assert(notification->BytesToScan <= SCANNER_READ_BUFFER_SIZE);
-        _Analysis_assume_(notification->BytesToScan <= SCANNER_READ_BUFFER_SIZE);
-
-        result = ScanBuffer( notification->Contents, notification->BytesToScan );
-
         replyMessage.ReplyHeader.Status = 0;
         replyMessage.ReplyHeader.MessageId = message->MessageHeader.MessageId;
+        replyMessage.Reply.NeededChunks = 0;
 
-        //
-        //  Need to invert the boolean -- result is true if found
-        //  foul language, in which case SafeToOpen should be set to false.
-        //
+        if (notification->Type == ScannerMessageChunkHashes) {
+
+            assert(notification->ChunkCount <= SCANNER_MAX_CHUNKS);
+            _Analysis_assume_(notification->ChunkCount <= SCANNER_MAX_CHUNKS);
+
+            //
+            //  Ask for the contents of the chunks we haven't seen clean yet.
+            //
 
-        replyMessage.Reply.SafeToOpen = !result;
+            for (i = 0, known = 0; i < notification->ChunkCount; i++) {
+
+                if (IsChunkClean( &notification->Chunks[i] )) {
+
+                    known += 1;
+
+                } else {
+
+                    replyMessage.Reply.NeededChunks |= 1ULL << i;
+                }
+            }
+
+            printf( "Chunks already known clean: %d of %d\n", known, notification->ChunkCount );
+
+            replyMessage.Reply.SafeToOpen = TRUE;
+
+        } else {
+
+            assert(notification->BytesToScan <= SCANNER_READ_BUFFER_SIZE);
+            _Analysis_assume_(notification->BytesToScan <= SCANNER_READ_BUFFER_SIZE);
+
+            result = ScanBuffer( notification->Contents, notification->BytesToScan );
+
+            //
+            //  Only whole chunks of a file can be seen again on a rescan.
+            //
+
+            if (!result && (notification->ChunkCount == 1)) {
+
+                RememberCleanChunk( notification->Contents, notification->BytesToScan );
+            }
+
+            //
+            //  Need to invert the boolean -- result is true if found
+            //  foul language, in which case SafeToOpen should be set to false.
+            //
+
+            replyMessage.Reply.SafeToOpen = !result;
+        }
 
         printf( "Replying message, SafeToOpen: %d\n", replyMessage.Reply.SafeToOpen );
 
@@ -87,6 +87,7 @@ Environment:
 
 #define SIMREP_STRING_TAG            'tSpR'
 #define SIMREP_REG_TAG               'eRpR'
+#define SIMREP_MAPPING_TAG           'mMpR'
 
 //
 // Constants
@@ -96,6 +97,22 @@ Environment:
 
 #define REPLACE_QUERY_DIRECTORY_FILE_ROUTINE_NAME_STRING "FltQueryDirectoryFile"
 
+//
+//  Upper bound on the number of mappings read from the "Mappings" registry
+//  value.
+//
+
+#define SIMREP_MAX_MAPPINGS         1024
+
+//
+//  Parameters of the FNV-1a hash used for the mapping trie path components.
+//
+
+#define SIMREP_HASH_OFFSET_BASIS    0x811C9DC5
+#define SIMREP_HASH_PRIME           0x01000193
+
+#define SIMREP_ALIGN_POINTER(_x)    (((_x) + sizeof(PVOID) - 1) & ~(sizeof(PVOID) - 1))
+
 
 //
 //  Context sample filter global data structures.
@@ -118,6 +135,79 @@ typedef struct _MAPPING_ENTRY {
 } MAPPING_ENTRY, *PMAPPING_ENTRY;
 
 
+//
+//  A node of a mapping trie.  Every node stands for one path component.
+//  The path from the root to a node spells out a mapping path, and if a
+//  mapping has exactly that path the node points at it.
+//
+
+typedef struct _SIMREP_TRIE_NODE {
+
+    //
+    //  Case insensitive hash of Component, compared before the string.
+    //
+
+    ULONG Hash;
+
+    //
+    //  Path component this node stands for.
+    //
+
+    UNICODE_STRING Component;
+
+    //
+    //  Mapping whose path ends at this node, or NULL.
+    //
+
+    PMAPPING_ENTRY Mapping;
+
+    //
+    //  Children of this node and the next child of its parent.
+    //
+
+    struct _SIMREP_TRIE_NODE *FirstChild;
+    struct _SIMREP_TRIE_NODE *NextSibling;
+
+} SIMREP_TRIE_NODE, *PSIMREP_TRIE_NODE;
+
+
+//
+//  A compiled set of mappings.  The mappings are indexed by two tries, one
+//  over the old paths (for reparsing creates) and one over the new paths
+//  (for redirecting renames and links).
+//
+//  The table is a single allocation, strings included, and it is never
+//  changed once it is built.  When the configuration changes a new table is
+//  built and swapped in; operations still using the old table hold a
+//  reference to it.
+//
+
+typedef struct _SIMREP_MAPPING_TABLE {
+
+    //
+    //  References to this table.  Globals.MappingTable holds one.
+    //
+
+    volatile LONG RefCount;
+
+    //
+    //  Number of mappings in Mappings.
+    //
+
+    ULONG MappingCount;
+
+    PMAPPING_ENTRY Mappings;
+
+    //
+    //  Roots of the old path and new path tries.
+    //
+
+    PSIMREP_TRIE_NODE OldNameRoot;
+    PSIMREP_TRIE_NODE NewNameRoot;
+
+} SIMREP_MAPPING_TABLE, *PSIMREP_MAPPING_TABLE;
+
+
 //
 //  Starting with windows 7, the IO Manager provides IoReplaceFileObjectName, 
 //  but old versions of Windows will not have this function. Rather than just 
@@ -158,10 +248,44 @@ typedef struct _SIMREP_GLOBAL_DATA {
     PFLT_FILTER Filter;
 
     //
-    //  Structure to hold mapping information.
+    //  The current mapping table and the lock protecting the pointer.
+    //
+
+    PSIMREP_MAPPING_TABLE MappingTable;
+
+    EX_PUSH_LOCK MappingTableLock;
+
+    //
+    //  Registry key the configuration is read from.  It stays open while
+    //  the filter is loaded so that changes to the mappings are picked up
+    //  without reloading the filter.
+    //
+
+    HANDLE ConfigurationKey;
+
+    //
+    //  Work item queued by the registry when the configuration key changes.
+    //
+
+    WORK_QUEUE_ITEM ConfigurationChangeWorkItem;
+
+    IO_STATUS_BLOCK ConfigurationChangeIoStatus;
+
+    //
+    //  Serializes the configuration change worker against unload.
+    //
+
+    EX_PUSH_LOCK ConfigurationLock;
+
+    //
+    //  Signaled once a change notification is no longer pending.
     //
 
-    MAPPING_ENTRY Mapping;
+    KEVENT ConfigurationWatchStopped;
+
+    BOOLEAN ConfigurationWatchActive;
+
+    BOOLEAN Unloading;
 
     //
     //  Pointer to the function we will use to 
@@ -339,6 +463,86 @@ SimRepMungeName(
     _Out_ PUNICODE_STRING MungedPath
     );
 
+//
+//  Functions that build, look up and replace the mapping table
+//
+
+NTSTATUS
+SimRepQueryRegistryValue (
+    _In_ HANDLE Key,
+    _In_ PCWSTR ValueName,
+    _Outptr_ PKEY_VALUE_PARTIAL_INFORMATION *Value
+    );
+
+NTSTATUS
+SimRepReadMappingTable (
+    _In_ HANDLE ConfigurationKey,
+    _Outptr_ PSIMREP_MAPPING_TABLE *MappingTable
+    );
+
+NTSTATUS
+SimRepBuildMappingTable (
+    _In_reads_(MappingCount) PMAPPING_ENTRY Mappings,
+    _In_ ULONG MappingCount,
+    _Outptr_ PSIMREP_MAPPING_TABLE *MappingTable
+    );
+
+BOOLEAN
+SimRepNextPathComponent (
+    _In_ PCUNICODE_STRING Path,
+    _Inout_ PUSHORT Index,
+    _Out_ PUNICODE_STRING Component,
+    _Out_ PULONG Hash
+    );
+
+VOID
+SimRepInsertMapping (
+    _In_ PSIMREP_TRIE_NODE Root,
+    _In_ PUNICODE_STRING MappingPath,
+    _In_ PMAPPING_ENTRY Mapping,
+    _Inout_ PSIMREP_TRIE_NODE *NextFreeNode
+    );
+
+PMAPPING_ENTRY
+SimRepLookupMapping (
+    _In_ PSIMREP_MAPPING_TABLE MappingTable,
+    _In_ PFLT_FILE_NAME_INFORMATION NameInfo,
+    _In_ BOOLEAN ByNewName,
+    _In_ BOOLEAN IgnoreCase,
+    _Out_opt_ PBOOLEAN ExactMatch
+    );
+
+PSIMREP_MAPPING_TABLE
+SimRepReferenceMappingTable (
+    VOID
+    );
+
+VOID
+SimRepDereferenceMappingTable (
+    _In_ PSIMREP_MAPPING_TABLE MappingTable
+    );
+
+VOID
+SimRepSwapMappingTable (
+    _In_opt_ PSIMREP_MAPPING_TABLE NewMappingTable
+    );
+
+NTSTATUS
+SimRepArmConfigurationWatch (
+    VOID
+    );
+
+WORKER_THREAD_ROUTINE SimRepConfigurationChangeWorker;
+VOID
+SimRepConfigurationChangeWorker (
+    _In_ PVOID Parameter
+    );
+
+VOID
+SimRepStopConfigurationWatch (
+    VOID
+    );
+
 //
 //  Functions that implement a pass through name provider
 //
@@ -515,6 +719,18 @@ SIMREP_GLOBAL_DATA Globals;
 #pragma alloc_text(PAGE, SimRepReplaceFileObjectName)
 #pragma alloc_text(PAGE, SimRepCompareMapping)
 #pragma alloc_text(PAGE, SimRepMungeName)
+#pragma alloc_text(PAGE, SimRepQueryRegistryValue)
+#pragma alloc_text(PAGE, SimRepReadMappingTable)
+#pragma alloc_text(PAGE, SimRepBuildMappingTable)
+#pragma alloc_text(PAGE, SimRepNextPathComponent)
+#pragma alloc_text(PAGE, SimRepInsertMapping)
+#pragma alloc_text(PAGE, SimRepLookupMapping)
+#pragma alloc_text(PAGE, SimRepReferenceMappingTable)
+#pragma alloc_text(PAGE, SimRepDereferenceMappingTable)
+#pragma alloc_text(PAGE, SimRepSwapMappingTable)
+#pragma alloc_text(PAGE, SimRepArmConfigurationWatch)
+#pragma alloc_text(PAGE, SimRepConfigurationChangeWorker)
+#pragma alloc_text(PAGE, SimRepStopConfigurationWatch)
 #pragma alloc_text(PAGE, SimRepPreCreate)
 #pragma alloc_text(PAGE, SimRepPreNetworkQueryOpen)
 #pragma alloc_text(PAGE, SimRepPreSetInformation)
@@ -583,9 +799,24 @@ Return Value:
 
     Globals.RemapRenamesAndLinks = FALSE;
 
-    RtlInitUnicodeString( &Globals.Mapping.NewName, NULL );
+    FltInitializePushLock( &Globals.MappingTableLock );
 
-    RtlInitUnicodeString( &Globals.Mapping.OldName, NULL );
+    FltInitializePushLock( &Globals.ConfigurationLock );
+
+    //
+    //  The configuration watch starts out stopped.
+    //
+
+    KeInitializeEvent( &Globals.ConfigurationWatchStopped, NotificationEvent, TRUE );
+
+#pragma warning(push)
+#pragma warning(disable:4996) // ExInitializeWorkItem is deprecated, but ZwNotifyChangeKey requires a WORK_QUEUE_ITEM
+
+    ExInitializeWorkItem( &Globals.ConfigurationChangeWorkItem,
+                          SimRepConfigurationChangeWorker,
+                          NULL );
+
+#pragma warning(pop)
 
     //
     //  Import function to replace file names.
@@ -693,10 +924,7 @@ Return Value:
     PKEY_VALUE_PARTIAL_INFORMATION value = (PKEY_VALUE_PARTIAL_INFORMATION)buffer;
     ULONG valueLength = sizeof(buffer);
     ULONG resultLength;
-    PKEY_VALUE_PARTIAL_INFORMATION mappingValue = NULL;
-    ULONG mappingValueLength = 0;
-    WCHAR oldMappingTail;
-    WCHAR newMappingTail;
+    PSIMREP_MAPPING_TABLE mappingTable;
 
     PAGED_CODE();
 
@@ -762,192 +990,40 @@ Return Value:
     }
 
     //
-    //  Query the length of the old mapping.
-    //
-    
-    RtlInitUnicodeString( &valueName, L"OldMapping" );
-
-    status = ZwQueryValueKey( driverRegKey,
-                              &valueName,
-                              KeyValuePartialInformation,
-                              NULL,
-                              0,
-                              &mappingValueLength );
-
-    if (status!=STATUS_BUFFER_TOO_SMALL && status!=STATUS_BUFFER_OVERFLOW) {
-
-        status = STATUS_INVALID_PARAMETER;
-        goto SimRepSetConfigurationCleanup;
-    }
-
-    //
-    //  Extract the old mapping string.
-    //
-
-    mappingValue = ExAllocatePoolWithTag( PagedPool,
-                                          mappingValueLength,
-                                          SIMREP_REG_TAG );
-
-    if (mappingValue == NULL) {
-
-        status = STATUS_INSUFFICIENT_RESOURCES;
-        goto SimRepSetConfigurationCleanup;
-    }
-
-    status = ZwQueryValueKey( driverRegKey,
-                              &valueName,
-                              KeyValuePartialInformation,
-                              mappingValue,
-                              mappingValueLength,
-                              &resultLength );
-
-    if (!NT_SUCCESS( status )) {
-
-        goto SimRepSetConfigurationCleanup;
-    }
-
-    if (mappingValue->Type != REG_SZ) {
-
-        status = STATUS_INVALID_PARAMETER;
-        goto SimRepSetConfigurationCleanup;
-    }
-
-    Globals.Mapping.OldName.MaximumLength = (USHORT)mappingValue->DataLength;
-
-    status = SimRepAllocateUnicodeString( &Globals.Mapping.OldName );
-
-    if (!NT_SUCCESS( status )) {
-
-        goto SimRepSetConfigurationCleanup;
-    }
-
-    //   
-    //  The length which we receive from ZwQueryValueKey contains size for   
-    //  the NULL termination as well. Since we are dealing with unicode   
-    //  string we'll chop off the null termination in the length.   
-    //   
-
-    Globals.Mapping.OldName.Length = (USHORT)mappingValue->DataLength - sizeof( UNICODE_NULL );
-
-    RtlCopyMemory(Globals.Mapping.OldName.Buffer,
-                  mappingValue->Data,
-                  Globals.Mapping.OldName.Length);
-
-    //
-    //  Query the length of the new mapping.
-    //
-    
-    RtlInitUnicodeString( &valueName, L"NewMapping" );
-
-    status = ZwQueryValueKey( driverRegKey,
-                              &valueName,
-                              KeyValuePartialInformation,
-                              mappingValue,
-                              mappingValueLength,
-                              &mappingValueLength );
-
-    if (!NT_SUCCESS( status )) {
-        
-        if (status!=STATUS_BUFFER_TOO_SMALL && status!=STATUS_BUFFER_OVERFLOW) {
-
-            goto SimRepSetConfigurationCleanup;
-        }
-
-        ExFreePoolWithTag( mappingValue, SIMREP_REG_TAG );
-
-        mappingValue = ExAllocatePoolWithTag( PagedPool,
-                                               mappingValueLength,
-                                               SIMREP_REG_TAG );
-
-        if (mappingValue == NULL) {
-
-            status = STATUS_INSUFFICIENT_RESOURCES;
-            goto SimRepSetConfigurationCleanup;
-        }        
-        
-    }
-
-    //
-    //  Extract the new mapping string.
+    //  Read and compile the mappings.
     //
 
-    status = ZwQueryValueKey( driverRegKey,
-                              &valueName,
-                              KeyValuePartialInformation,
-                              mappingValue,
-                              mappingValueLength,
-                              &mappingValueLength );
-
-    if (!NT_SUCCESS( status )) {
-
-        goto SimRepSetConfigurationCleanup;
-    }
-
-    
-    if (mappingValue->Type != REG_SZ) {
-
-        status = STATUS_INVALID_PARAMETER;
-        goto SimRepSetConfigurationCleanup;
-    }
-
-    Globals.Mapping.NewName.MaximumLength = (USHORT) mappingValue->DataLength;
-    
-    status = SimRepAllocateUnicodeString( &Globals.Mapping.NewName );
+    status = SimRepReadMappingTable( driverRegKey, &mappingTable );
 
     if (!NT_SUCCESS( status )) {
 
         goto SimRepSetConfigurationCleanup;
     }
 
-    //   
-    //  The length which we receive from ZwQueryValueKey contains size for   
-    //  the NULL termination as well. Since we are dealing with unicode   
-    //  string we'll chop off the null termination in the length.   
-    //   
-
-    Globals.Mapping.NewName.Length = (USHORT)mappingValue->DataLength - sizeof( UNICODE_NULL );
-
-    RtlCopyMemory(Globals.Mapping.NewName.Buffer,
-                  mappingValue->Data,
-                  Globals.Mapping.NewName.Length);
-
+    SimRepSwapMappingTable( mappingTable );
 
     //
-    //  Ensure the old and new mapping are consistent in specifying either files or directories
-    //  as determined by the presence of a trailing backslash
+    //  Keep the key open and watch it, so that changes to the mappings are
+    //  applied while the filter is running.  Failing to watch the key is not
+    //  fatal; the mappings just stay as they were loaded.
     //
 
-    oldMappingTail = (WCHAR)Globals.Mapping.OldName.Buffer[Globals.Mapping.OldName.Length / sizeof( WCHAR ) - 1];
-    newMappingTail = (WCHAR)Globals.Mapping.NewName.Buffer[Globals.Mapping.NewName.Length / sizeof( WCHAR ) - 1];
+    Globals.ConfigurationKey = driverRegKey;
+    driverRegKey = NULL;
 
-    if ((oldMappingTail != newMappingTail) &&
-        ((oldMappingTail == OBJ_NAME_PATH_SEPARATOR) ||
-         (newMappingTail == OBJ_NAME_PATH_SEPARATOR))) {
+    FltAcquirePushLockExclusive( &Globals.ConfigurationLock );
 
-        status = STATUS_INVALID_PARAMETER;
-        goto SimRepSetConfigurationCleanup;
-    }
+    SimRepArmConfigurationWatch();
 
+    FltReleasePushLock( &Globals.ConfigurationLock );
 
 SimRepSetConfigurationCleanup:
 
-    if (mappingValue != NULL) {
-
-        ExFreePoolWithTag( mappingValue, SIMREP_REG_TAG );
-        mappingValue = NULL;
-    }
-
     if (driverRegKey != NULL) {
 
         ZwClose( driverRegKey );
     }
 
-    if (!NT_SUCCESS( status )) {
-        
-        SimRepFreeUnicodeString( &Globals.Mapping.NewName );
-        SimRepFreeUnicodeString( &Globals.Mapping.OldName );
-    }
-    
     return status;
 }
 
@@ -972,8 +1048,13 @@ Return Value:
 {
     PAGED_CODE();
 
-    SimRepFreeUnicodeString( &Globals.Mapping.NewName );
-    SimRepFreeUnicodeString( &Globals.Mapping.OldName );
+    SimRepStopConfigurationWatch();
+
+    SimRepSwapMappingTable( NULL );
+
+    FltDeletePushLock( &Globals.ConfigurationLock );
+
+    FltDeletePushLock( &Globals.MappingTableLock );
 }
 
 NTSTATUS
@@ -1165,7 +1246,8 @@ Return Value:
     PFLT_FILE_NAME_INFORMATION nameInfo = NULL;
     NTSTATUS status;
     FLT_PREOP_CALLBACK_STATUS callbackStatus;
-    BOOLEAN match;
+    PSIMREP_MAPPING_TABLE mappingTable = NULL;
+    PMAPPING_ENTRY mapping = NULL;
     PIO_STACK_LOCATION irpSp;
     
     UNREFERENCED_PARAMETER( FltObjects );
@@ -1282,12 +1364,18 @@ Return Value:
     //  Note: if the create is case sensitive this comparison must be as well.
     //
 
-    match = SimRepCompareMapping( nameInfo,
-                                  &Globals.Mapping.OldName,
-                                  !FlagOn( irpSp->Flags, SL_CASE_SENSITIVE ),
-                                  NULL );
+    mappingTable = SimRepReferenceMappingTable();
 
-    if (match) {
+    if (mappingTable != NULL) {
+
+        mapping = SimRepLookupMapping( mappingTable,
+                                       nameInfo,
+                                       FALSE,
+                                       !FlagOn( irpSp->Flags, SL_CASE_SENSITIVE ),
+                                       NULL );
+    }
+
+    if (mapping != NULL) {
 
         DebugTrace( DEBUG_TRACE_REPARSE_OPERATIONS,
                     ("[SimRep]: SimRepPreNetworkQueryOpen -> File name %wZ matches mapping. (Cbd = %p, FileObject = %p)\n"
@@ -1296,8 +1384,8 @@ Return Value:
                      &nameInfo->Name,
                      Cbd,
                      FltObjects->FileObject,
-                     Globals.Mapping.OldName,
-                     Globals.Mapping.NewName) );
+                     &mapping->OldName,
+                     &mapping->NewName) );
 
         //
         // Because the file matched the mapping, we need to redirect this open with a new name.
@@ -1323,6 +1411,11 @@ SimRepPreNetworkQueryOpenCleanup:
     //  Release the references we have acquired
     //    
     
+    if (mappingTable != NULL) {
+
+        SimRepDereferenceMappingTable( mappingTable );
+    }
+
     if (nameInfo != NULL) {
 
         FltReleaseFileNameInformation( nameInfo );
@@ -1395,6 +1488,8 @@ Return Value:
     NTSTATUS status;
     FLT_PREOP_CALLBACK_STATUS callbackStatus;
     UNICODE_STRING newFileName;
+    PSIMREP_MAPPING_TABLE mappingTable = NULL;
+    PMAPPING_ENTRY mapping = NULL;
     
     UNREFERENCED_PARAMETER( FltObjects );
     UNREFERENCED_PARAMETER( CompletionContext );
@@ -1580,9 +1675,25 @@ Return Value:
     //  must be as well.
     //
 
+    mappingTable = SimRepReferenceMappingTable();
+
+    if (mappingTable != NULL) {
+
+        mapping = SimRepLookupMapping( mappingTable,
+                                       nameInfo,
+                                       FALSE,
+                                       !FlagOn( Cbd->Iopb->OperationFlags, SL_CASE_SENSITIVE ),
+                                       NULL );
+    }
+
+    if (mapping == NULL) {
+
+        goto SimRepPreCreateCleanup;
+    }
+
     status = SimRepMungeName( nameInfo,
-                              &Globals.Mapping.OldName,
-                              &Globals.Mapping.NewName,
+                              &mapping->OldName,
+                              &mapping->NewName,
                               !FlagOn( Cbd->Iopb->OperationFlags, SL_CASE_SENSITIVE ),                             
                               FALSE,
                               &newFileName);
@@ -1603,8 +1714,8 @@ Return Value:
                  &nameInfo->Name,
                  Cbd,
                  FltObjects->FileObject,
-                 Globals.Mapping.OldName,
-                 Globals.Mapping.NewName) );
+                 &mapping->OldName,
+                 &mapping->NewName) );
 
 
     //
@@ -1649,6 +1760,11 @@ SimRepPreCreateCleanup:
 
     SimRepFreeUnicodeString( &newFileName );
     
+    if (mappingTable != NULL) {
+
+        SimRepDereferenceMappingTable( mappingTable );
+    }
+
     if (nameInfo != NULL) {
 
         FltReleaseFileNameInformation( nameInfo );
@@ -1728,6 +1844,9 @@ Return Value:
     PFILE_LINK_INFORMATION newLinkInfo = NULL;
     PFLT_FILE_NAME_INFORMATION nameInfo = NULL;
     UNICODE_STRING newFileName;
+    PSIMREP_MAPPING_TABLE mappingTable = NULL;
+    PMAPPING_ENTRY mapping = NULL;
+    BOOLEAN exactMatch = FALSE;
 
     struct {
         BOOLEAN ReplaceIfExists;
@@ -1884,30 +2003,57 @@ Return Value:
     //  string to send in the request.
     //
 
-    status = SimRepMungeName( nameInfo,
-                              &Globals.Mapping.NewName,
-                              &Globals.Mapping.NewName,
-                              !FlagOn( FltObjects->FileObject->Flags, FO_OPENED_CASE_SENSITIVE ),
-                              FALSE,
-                              &newFileName );
-
-    if (status == STATUS_NOT_FOUND) {
+    mappingTable = SimRepReferenceMappingTable();
 
-        //
-        //  If the operation destination overlaps the old mapping exactly, get 
-        //  a new filename string munged with the new mapping to send in the 
-        //  request. This is a special case where our name provider will not 
-        //  perform the reparse during name resolution because the parent
-        //  directories don't overlap the mapping.
-        //
+    if (mappingTable == NULL) {
+
+        goto SimRepPreSetInformationCleanup;
+    }
+
+    status = STATUS_NOT_FOUND;
+
+    mapping = SimRepLookupMapping( mappingTable,
+                                   nameInfo,
+                                   TRUE,
+                                   !FlagOn( FltObjects->FileObject->Flags, FO_OPENED_CASE_SENSITIVE ),
+                                   NULL );
+
+    if (mapping != NULL) {
 
         status = SimRepMungeName( nameInfo,
-                                  &Globals.Mapping.OldName,
-                                  &Globals.Mapping.NewName,
+                                  &mapping->NewName,
+                                  &mapping->NewName,
                                   !FlagOn( FltObjects->FileObject->Flags, FO_OPENED_CASE_SENSITIVE ),
-                                  TRUE,
+                                  FALSE,
                                   &newFileName );
     }
+
+    if (status == STATUS_NOT_FOUND) {
+
+        //
+        //  If the operation destination overlaps the old mapping exactly, get 
+        //  a new filename string munged with the new mapping to send in the 
+        //  request. This is a special case where our name provider will not 
+        //  perform the reparse during name resolution because the parent
+        //  directories don't overlap the mapping.
+        //
+
+        mapping = SimRepLookupMapping( mappingTable,
+                                       nameInfo,
+                                       FALSE,
+                                       !FlagOn( FltObjects->FileObject->Flags, FO_OPENED_CASE_SENSITIVE ),
+                                       &exactMatch );
+
+        if (mapping != NULL && exactMatch) {
+
+            status = SimRepMungeName( nameInfo,
+                                      &mapping->OldName,
+                                      &mapping->NewName,
+                                      !FlagOn( FltObjects->FileObject->Flags, FO_OPENED_CASE_SENSITIVE ),
+                                      TRUE,
+                                      &newFileName );
+        }
+    }
         
     if (!NT_SUCCESS( status )) {
 
@@ -1993,6 +2139,11 @@ Return Value:
 
 SimRepPreSetInformationCleanup:
 
+    if (mappingTable != NULL) {
+
+        SimRepDereferenceMappingTable( mappingTable );
+    }
+
     if (nameInfo) {
         
         FltReleaseFileNameInformation( nameInfo );
@@ -2393,6 +2544,1053 @@ Return Value:
 }
 
 
+//
+//  Mapping table routines.
+//
+//  SimRep can be configured with many mappings.  They are compiled into a
+//  SIMREP_MAPPING_TABLE, which indexes them with a trie keyed on path
+//  components, so operations find the mapping for a name by walking the
+//  name once instead of comparing it against every mapping.  Lookups only
+//  read the table and do not allocate.
+//
+
+NTSTATUS
+SimRepQueryRegistryValue (
+    _In_ HANDLE Key,
+    _In_ PCWSTR ValueName,
+    _Outptr_ PKEY_VALUE_PARTIAL_INFORMATION *Value
+    )
+/*++
+
+Routine Description:
+
+    This routine reads a registry value into a buffer allocated from paged
+    pool.
+
+Arguments:
+
+    Key - Handle to the key holding the value.
+
+    ValueName - Name of the value to read.
+
+    Value - Receives the value.  The caller frees it with
+            ExFreePoolWithTag and SIMREP_REG_TAG.
+
+Return Value:
+
+    STATUS_SUCCESS - the value was read.
+    STATUS_OBJECT_NAME_NOT_FOUND - the value does not exist.
+    An appropriate NTSTATUS error otherwise.
+
+--*/
+{
+    NTSTATUS status;
+    UNICODE_STRING valueName;
+    PKEY_VALUE_PARTIAL_INFORMATION value;
+    ULONG valueLength = 0;
+
+    PAGED_CODE();
+
+    *Value = NULL;
+
+    RtlInitUnicodeString( &valueName, ValueName );
+
+    status = ZwQueryValueKey( Key,
+                              &valueName,
+                              KeyValuePartialInformation,
+                              NULL,
+                              0,
+                              &valueLength );
+
+    if (status != STATUS_BUFFER_TOO_SMALL && status != STATUS_BUFFER_OVERFLOW) {
+
+        return NT_SUCCESS( status ) ? STATUS_INVALID_PARAMETER : status;
+    }
+
+    value = ExAllocatePoolWithTag( PagedPool,
+                                   valueLength,
+                                   SIMREP_REG_TAG );
+
+    if (value == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    status = ZwQueryValueKey( Key,
+                              &valueName,
+                              KeyValuePartialInformation,
+                              value,
+                              valueLength,
+                              &valueLength );
+
+    if (!NT_SUCCESS( status )) {
+
+        ExFreePoolWithTag( value, SIMREP_REG_TAG );
+        return status;
+    }
+
+    *Value = value;
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+SimRepReadMappingTable (
+    _In_ HANDLE ConfigurationKey,
+    _Outptr_ PSIMREP_MAPPING_TABLE *MappingTable
+    )
+/*++
+
+Routine Description:
+
+    This routine reads the mappings from the registry and compiles them
+    into a new mapping table.
+
+    The mappings come from two places, both optional:
+
+    OldMapping/NewMapping - REG_SZ values holding a single mapping.
+
+    Mappings - A REG_MULTI_SZ value holding any number of mappings as
+               alternating old and new paths.
+
+    At least one mapping must be configured.
+
+Arguments:
+
+    ConfigurationKey - Handle to the SimRep registry key.
+
+    MappingTable - Receives the new mapping table, with a single reference.
+
+Return Value:
+
+    STATUS_SUCCESS - the table was built.
+    STATUS_INVALID_PARAMETER - the configuration is not valid.
+    An appropriate NTSTATUS error otherwise.
+
+--*/
+{
+    NTSTATUS status;
+    PKEY_VALUE_PARTIAL_INFORMATION oldMappingValue = NULL;
+    PKEY_VALUE_PARTIAL_INFORMATION newMappingValue = NULL;
+    PKEY_VALUE_PARTIAL_INFORMATION mappingsValue = NULL;
+    PMAPPING_ENTRY mappings = NULL;
+    ULONG maxMappings = 1;
+    ULONG mappingCount = 0;
+    UNICODE_STRING paths[2];
+    ULONG pathCount = 0;
+    PWCHAR current;
+    PWCHAR end;
+    ULONG length;
+    ULONG index;
+    USHORT componentIndex;
+    UNICODE_STRING component;
+    ULONG hash;
+    WCHAR oldMappingTail;
+    WCHAR newMappingTail;
+
+    PAGED_CODE();
+
+    *MappingTable = NULL;
+
+    //
+    //  Query the single mapping.
+    //
+
+    status = SimRepQueryRegistryValue( ConfigurationKey,
+                                       L"OldMapping",
+                                       &oldMappingValue );
+
+    if (NT_SUCCESS( status )) {
+
+        status = SimRepQueryRegistryValue( ConfigurationKey,
+                                           L"NewMapping",
+                                           &newMappingValue );
+    }
+
+    if (!NT_SUCCESS( status ) && status != STATUS_OBJECT_NAME_NOT_FOUND) {
+
+        goto SimRepReadMappingTableCleanup;
+    }
+
+    //
+    //  Query the mapping list.
+    //
+
+    status = SimRepQueryRegistryValue( ConfigurationKey,
+                                       L"Mappings",
+                                       &mappingsValue );
+
+    if (!NT_SUCCESS( status ) && status != STATUS_OBJECT_NAME_NOT_FOUND) {
+
+        goto SimRepReadMappingTableCleanup;
+    }
+
+    if (mappingsValue != NULL) {
+
+        if (mappingsValue->Type != REG_MULTI_SZ) {
+
+            status = STATUS_INVALID_PARAMETER;
+            goto SimRepReadMappingTableCleanup;
+        }
+
+        //
+        //  Every mapping takes at least two characters and two terminators.
+        //
+
+        maxMappings += mappingsValue->DataLength / (4 * sizeof( WCHAR ));
+
+        if (maxMappings > SIMREP_MAX_MAPPINGS) {
+
+            maxMappings = SIMREP_MAX_MAPPINGS;
+        }
+    }
+
+    mappings = ExAllocatePoolWithTag( PagedPool,
+                                      maxMappings * sizeof( MAPPING_ENTRY ),
+                                      SIMREP_REG_TAG );
+
+    if (mappings == NULL) {
+
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto SimRepReadMappingTableCleanup;
+    }
+
+    if (oldMappingValue != NULL && newMappingValue != NULL) {
+
+        if (oldMappingValue->Type != REG_SZ ||
+            newMappingValue->Type != REG_SZ ||
+            oldMappingValue->DataLength < sizeof( UNICODE_NULL ) ||
+            newMappingValue->DataLength < sizeof( UNICODE_NULL ) ||
+            oldMappingValue->DataLength > MAXUSHORT ||
+            newMappingValue->DataLength > MAXUSHORT) {
+
+            status = STATUS_INVALID_PARAMETER;
+            goto SimRepReadMappingTableCleanup;
+        }
+
+        //   
+        //  The length which we receive from ZwQueryValueKey contains size for   
+        //  the NULL termination as well. Since we are dealing with unicode   
+        //  string we'll chop off the null termination in the length.   
+        //   
+
+        mappings[0].OldName.Buffer = (PWCH)oldMappingValue->Data;
+        mappings[0].OldName.Length = (USHORT)oldMappingValue->DataLength - sizeof( UNICODE_NULL );
+        mappings[0].OldName.MaximumLength = mappings[0].OldName.Length;
+
+        mappings[0].NewName.Buffer = (PWCH)newMappingValue->Data;
+        mappings[0].NewName.Length = (USHORT)newMappingValue->DataLength - sizeof( UNICODE_NULL );
+        mappings[0].NewName.MaximumLength = mappings[0].NewName.Length;
+
+        mappingCount = 1;
+    }
+
+    if (mappingsValue != NULL) {
+
+        current = (PWCHAR)mappingsValue->Data;
+        end = (PWCHAR)Add2Ptr( mappingsValue->Data, mappingsValue->DataLength & ~(sizeof( WCHAR ) - 1) );
+
+        while (current < end && *current != UNICODE_NULL) {
+
+            length = 0;
+
+            while (&current[length] < end && current[length] != UNICODE_NULL) {
+
+                length++;
+            }
+
+            if (length * sizeof( WCHAR ) > MAXUSHORT) {
+
+                status = STATUS_INVALID_PARAMETER;
+                goto SimRepReadMappingTableCleanup;
+            }
+
+            paths[pathCount].Buffer = current;
+            paths[pathCount].Length = (USHORT)(length * sizeof( WCHAR ));
+            paths[pathCount].MaximumLength = paths[pathCount].Length;
+            pathCount++;
+
+            current += length + 1;
+
+            if (pathCount == 2) {
+
+                if (mappingCount == maxMappings) {
+
+                    DebugTrace( DEBUG_TRACE_ERROR,
+                                ("[SimRep]: SimRepReadMappingTable -> Too many mappings, at most %u are supported\n",
+                                 SIMREP_MAX_MAPPINGS) );
+
+                    status = STATUS_INVALID_PARAMETER;
+                    goto SimRepReadMappingTableCleanup;
+                }
+
+                mappings[mappingCount].OldName = paths[0];
+                mappings[mappingCount].NewName = paths[1];
+                mappingCount++;
+                pathCount = 0;
+            }
+        }
+
+        if (pathCount != 0) {
+
+            //
+            //  An old path without a new path.
+            //
+
+            status = STATUS_INVALID_PARAMETER;
+            goto SimRepReadMappingTableCleanup;
+        }
+    }
+
+    if (mappingCount == 0) {
+
+        status = STATUS_INVALID_PARAMETER;
+        goto SimRepReadMappingTableCleanup;
+    }
+
+    for (index = 0; index < mappingCount; index++) {
+
+        //
+        //  Both paths need at least one component.
+        //
+
+        componentIndex = 0;
+
+        if (!SimRepNextPathComponent( &mappings[index].OldName, &componentIndex, &component, &hash )) {
+
+            status = STATUS_INVALID_PARAMETER;
+            goto SimRepReadMappingTableCleanup;
+        }
+
+        componentIndex = 0;
+
+        if (!SimRepNextPathComponent( &mappings[index].NewName, &componentIndex, &component, &hash )) {
+
+            status = STATUS_INVALID_PARAMETER;
+            goto SimRepReadMappingTableCleanup;
+        }
+
+        //
+        //  Ensure the old and new mapping are consistent in specifying either files or directories
+        //  as determined by the presence of a trailing backslash
+        //
+
+        oldMappingTail = mappings[index].OldName.Buffer[mappings[index].OldName.Length / sizeof( WCHAR ) - 1];
+        newMappingTail = mappings[index].NewName.Buffer[mappings[index].NewName.Length / sizeof( WCHAR ) - 1];
+
+        if ((oldMappingTail != newMappingTail) &&
+            ((oldMappingTail == OBJ_NAME_PATH_SEPARATOR) ||
+             (newMappingTail == OBJ_NAME_PATH_SEPARATOR))) {
+
+            status = STATUS_INVALID_PARAMETER;
+            goto SimRepReadMappingTableCleanup;
+        }
+    }
+
+    status = SimRepBuildMappingTable( mappings,
+                                      mappingCount,
+                                      MappingTable );
+
+SimRepReadMappingTableCleanup:
+
+    if (mappings != NULL) {
+
+        ExFreePoolWithTag( mappings, SIMREP_REG_TAG );
+    }
+
+    if (mappingsValue != NULL) {
+
+        ExFreePoolWithTag( mappingsValue, SIMREP_REG_TAG );
+    }
+
+    if (newMappingValue != NULL) {
+
+        ExFreePoolWithTag( newMappingValue, SIMREP_REG_TAG );
+    }
+
+    if (oldMappingValue != NULL) {
+
+        ExFreePoolWithTag( oldMappingValue, SIMREP_REG_TAG );
+    }
+
+    return status;
+}
+
+
+NTSTATUS
+SimRepBuildMappingTable (
+    _In_reads_(MappingCount) PMAPPING_ENTRY Mappings,
+    _In_ ULONG MappingCount,
+    _Outptr_ PSIMREP_MAPPING_TABLE *MappingTable
+    )
+/*++
+
+Routine Description:
+
+    This routine compiles a set of mappings into a mapping table.  The table
+    header, the mappings, the trie nodes and the strings are all placed in a
+    single allocation, so the table is freed with one call.
+
+    If two mappings have the same old (or new) path, the first one wins.
+
+Arguments:
+
+    Mappings - The mappings to compile.  The strings are copied.
+
+    MappingCount - Number of entries in Mappings.
+
+    MappingTable - Receives the new mapping table, with a single reference.
+
+Return Value:
+
+    STATUS_SUCCESS - the table was built.
+    STATUS_INSUFFICIENT_RESOURCES - failure
+
+--*/
+{
+    PSIMREP_MAPPING_TABLE mappingTable;
+    PSIMREP_TRIE_NODE nodes;
+    PSIMREP_TRIE_NODE nextFreeNode;
+    PWCHAR strings;
+    PMAPPING_ENTRY mapping;
+    SIZE_T mappingsOffset;
+    SIZE_T nodesOffset;
+    SIZE_T stringsOffset;
+    SIZE_T stringsLength = 0;
+    ULONG nodeCount = 2;
+    ULONG index;
+    USHORT componentIndex;
+    UNICODE_STRING component;
+    ULONG hash;
+
+    PAGED_CODE();
+
+    *MappingTable = NULL;
+
+    //
+    //  Size the table.  Every path component may need its own node, plus
+    //  one root for each trie.
+    //
+
+    for (index = 0; index < MappingCount; index++) {
+
+        componentIndex = 0;
+
+        while (SimRepNextPathComponent( &Mappings[index].OldName, &componentIndex, &component, &hash )) {
+
+            nodeCount++;
+        }
+
+        componentIndex = 0;
+
+        while (SimRepNextPathComponent( &Mappings[index].NewName, &componentIndex, &component, &hash )) {
+
+            nodeCount++;
+        }
+
+        stringsLength += Mappings[index].OldName.Length + Mappings[index].NewName.Length;
+    }
+
+    mappingsOffset = SIMREP_ALIGN_POINTER( sizeof( SIMREP_MAPPING_TABLE ) );
+    nodesOffset = mappingsOffset + MappingCount * sizeof( MAPPING_ENTRY );
+    stringsOffset = nodesOffset + nodeCount * sizeof( SIMREP_TRIE_NODE );
+
+    mappingTable = ExAllocatePoolWithTag( PagedPool,
+                                          stringsOffset + stringsLength,
+                                          SIMREP_MAPPING_TAG );
+
+    if (mappingTable == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory( mappingTable, stringsOffset );
+
+    mappingTable->RefCount = 1;
+    mappingTable->MappingCount = MappingCount;
+    mappingTable->Mappings = Add2Ptr( mappingTable, mappingsOffset );
+
+    nodes = Add2Ptr( mappingTable, nodesOffset );
+    mappingTable->OldNameRoot = &nodes[0];
+    mappingTable->NewNameRoot = &nodes[1];
+    nextFreeNode = &nodes[2];
+
+    strings = Add2Ptr( mappingTable, stringsOffset );
+
+    for (index = 0; index < MappingCount; index++) {
+
+        mapping = &mappingTable->Mappings[index];
+
+        RtlCopyMemory( strings, Mappings[index].OldName.Buffer, Mappings[index].OldName.Length );
+        mapping->OldName.Buffer = strings;
+        mapping->OldName.Length = Mappings[index].OldName.Length;
+        mapping->OldName.MaximumLength = mapping->OldName.Length;
+        strings = Add2Ptr( strings, mapping->OldName.Length );
+
+        RtlCopyMemory( strings, Mappings[index].NewName.Buffer, Mappings[index].NewName.Length );
+        mapping->NewName.Buffer = strings;
+        mapping->NewName.Length = Mappings[index].NewName.Length;
+        mapping->NewName.MaximumLength = mapping->NewName.Length;
+        strings = Add2Ptr( strings, mapping->NewName.Length );
+
+        SimRepInsertMapping( mappingTable->OldNameRoot,
+                             &mapping->OldName,
+                             mapping,
+                             &nextFreeNode );
+
+        SimRepInsertMapping( mappingTable->NewNameRoot,
+                             &mapping->NewName,
+                             mapping,
+                             &nextFreeNode );
+    }
+
+    NT_ASSERT( nextFreeNode <= &nodes[nodeCount] );
+
+    DebugTrace( DEBUG_TRACE_LOAD_UNLOAD,
+                ("[SimRep]: SimRepBuildMappingTable -> Built table %p with %u mappings and %u trie nodes\n",
+                 mappingTable,
+                 MappingCount,
+                 (ULONG)(nextFreeNode - nodes)) );
+
+    *MappingTable = mappingTable;
+
+    return STATUS_SUCCESS;
+}
+
+
+BOOLEAN
+SimRepNextPathComponent (
+    _In_ PCUNICODE_STRING Path,
+    _Inout_ PUSHORT Index,
+    _Out_ PUNICODE_STRING Component,
+    _Out_ PULONG Hash
+    )
+/*++
+
+Routine Description:
+
+    This routine returns the next component of a path along with its case
+    insensitive hash.  Empty components are skipped.
+
+Arguments:
+
+    Path - The path being split.
+
+    Index - Character index in Path to start from.  Receives the index just
+            past the returned component.
+
+    Component - Receives the component.  It points into Path.
+
+    Hash - Receives the hash of the upcased component.
+
+Return Value:
+
+    TRUE - a component was returned.
+    FALSE - there are no more components in the path.
+
+--*/
+{
+    USHORT length = Path->Length / sizeof( WCHAR );
+    USHORT index = *Index;
+    USHORT start;
+    ULONG hash = SIMREP_HASH_OFFSET_BASIS;
+
+    PAGED_CODE();
+
+    while (index < length && Path->Buffer[index] == OBJ_NAME_PATH_SEPARATOR) {
+
+        index++;
+    }
+
+    if (index >= length) {
+
+        *Index = index;
+        return FALSE;
+    }
+
+    start = index;
+
+    while (index < length && Path->Buffer[index] != OBJ_NAME_PATH_SEPARATOR) {
+
+        hash = (hash ^ RtlUpcaseUnicodeChar( Path->Buffer[index] )) * SIMREP_HASH_PRIME;
+        index++;
+    }
+
+    Component->Buffer = &Path->Buffer[start];
+    Component->Length = (index - start) * sizeof( WCHAR );
+    Component->MaximumLength = Component->Length;
+
+    *Index = index;
+    *Hash = hash;
+
+    return TRUE;
+}
+
+
+VOID
+SimRepInsertMapping (
+    _In_ PSIMREP_TRIE_NODE Root,
+    _In_ PUNICODE_STRING MappingPath,
+    _In_ PMAPPING_ENTRY Mapping,
+    _Inout_ PSIMREP_TRIE_NODE *NextFreeNode
+    )
+/*++
+
+Routine Description:
+
+    This routine adds a mapping to a trie, creating the nodes for the
+    components of its path that are not in the trie yet.
+
+Arguments:
+
+    Root - Root of the trie.
+
+    MappingPath - The path of the mapping used as the key; either its old
+                  or its new path.
+
+    Mapping - The mapping to add.
+
+    NextFreeNode - Next unused node of the table.  Advanced for every node
+                   that is created.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PSIMREP_TRIE_NODE node = Root;
+    PSIMREP_TRIE_NODE child;
+    USHORT index = 0;
+    UNICODE_STRING component;
+    ULONG hash;
+
+    PAGED_CODE();
+
+    while (SimRepNextPathComponent( MappingPath, &index, &component, &hash )) {
+
+        for (child = node->FirstChild; child != NULL; child = child->NextSibling) {
+
+            if (child->Hash == hash &&
+                RtlEqualUnicodeString( &child->Component, &component, TRUE )) {
+
+                break;
+            }
+        }
+
+        if (child == NULL) {
+
+            child = *NextFreeNode;
+            *NextFreeNode = child + 1;
+
+            child->Hash = hash;
+            child->Component = component;
+            child->Mapping = NULL;
+            child->FirstChild = NULL;
+            child->NextSibling = node->FirstChild;
+            node->FirstChild = child;
+        }
+
+        node = child;
+    }
+
+    NT_ASSERT( node != Root );
+
+    if (node->Mapping == NULL) {
+
+        node->Mapping = Mapping;
+
+    } else {
+
+        DebugTrace( DEBUG_TRACE_ERROR,
+                    ("[SimRep]: SimRepInsertMapping -> Ignoring duplicate mapping path %wZ\n",
+                     MappingPath) );
+    }
+}
+
+
+PMAPPING_ENTRY
+SimRepLookupMapping (
+    _In_ PSIMREP_MAPPING_TABLE MappingTable,
+    _In_ PFLT_FILE_NAME_INFORMATION NameInfo,
+    _In_ BOOLEAN ByNewName,
+    _In_ BOOLEAN IgnoreCase,
+    _Out_opt_ PBOOLEAN ExactMatch
+    )
+/*++
+
+Routine Description:
+
+    This routine finds the mapping whose path is the file itself or its
+    closest ancestor.  It walks the file name one component at a time down
+    the trie, and checks the mappings it meets on the way with
+    SimRepCompareMapping, so a match means exactly what it meant for a
+    single mapping.
+
+Arguments:
+
+    MappingTable - The mapping table to search.
+
+    NameInfo - Pointer to the parsed name information for the file.
+
+    ByNewName - If TRUE match against the new paths of the mappings,
+                otherwise against the old paths.
+
+    IgnoreCase - If TRUE do a case insenstive comparison.
+
+    ExactMatch - If supplied receives TRUE if the name exactly matches the
+                 path of the returned mapping.
+
+Return Value:
+
+    The matching mapping, or NULL if the file is not in any mapping.
+
+--*/
+{
+    PSIMREP_TRIE_NODE node;
+    PSIMREP_TRIE_NODE child;
+    PMAPPING_ENTRY match = NULL;
+    BOOLEAN exactMatch = FALSE;
+    BOOLEAN nodeExactMatch;
+    UNICODE_STRING fileName;
+    UNICODE_STRING component;
+    USHORT index = 0;
+    ULONG hash;
+
+    PAGED_CODE();
+
+    NT_ASSERT( NameInfo->Name.Buffer == NameInfo->Volume.Buffer );
+    NT_ASSERT( NameInfo->Name.Length >= NameInfo->Volume.Length);
+
+    fileName.Buffer = Add2Ptr( NameInfo->Name.Buffer, NameInfo->Volume.Length );
+    fileName.MaximumLength = NameInfo->Name.Length - NameInfo->Volume.Length;
+    fileName.Length = fileName.MaximumLength;
+
+    node = ByNewName ? MappingTable->NewNameRoot : MappingTable->OldNameRoot;
+
+    while (node->FirstChild != NULL &&
+           SimRepNextPathComponent( &fileName, &index, &component, &hash )) {
+
+        for (child = node->FirstChild; child != NULL; child = child->NextSibling) {
+
+            if (child->Hash == hash &&
+                RtlEqualUnicodeString( &child->Component, &component, TRUE )) {
+
+                break;
+            }
+        }
+
+        if (child == NULL) {
+
+            break;
+        }
+
+        node = child;
+
+        //
+        //  The trie is case insensitive; SimRepCompareMapping applies the
+        //  case sensitivity of the operation and the rules for trailing
+        //  separators and streams.
+        //
+
+        if (node->Mapping != NULL &&
+            SimRepCompareMapping( NameInfo,
+                                  ByNewName ? &node->Mapping->NewName : &node->Mapping->OldName,
+                                  IgnoreCase,
+                                  &nodeExactMatch )) {
+
+            match = node->Mapping;
+            exactMatch = nodeExactMatch;
+        }
+    }
+
+    if (ARGUMENT_PRESENT( ExactMatch )) {
+
+        *ExactMatch = exactMatch;
+    }
+
+    return match;
+}
+
+
+PSIMREP_MAPPING_TABLE
+SimRepReferenceMappingTable (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    This routine returns a referenced pointer to the current mapping table.
+    The caller releases it with SimRepDereferenceMappingTable.
+
+Return Value:
+
+    The current mapping table, or NULL if there is none.
+
+--*/
+{
+    PSIMREP_MAPPING_TABLE mappingTable;
+
+    PAGED_CODE();
+
+    FltAcquirePushLockShared( &Globals.MappingTableLock );
+
+    mappingTable = Globals.MappingTable;
+
+    if (mappingTable != NULL) {
+
+        InterlockedIncrement( &mappingTable->RefCount );
+    }
+
+    FltReleasePushLock( &Globals.MappingTableLock );
+
+    return mappingTable;
+}
+
+
+VOID
+SimRepDereferenceMappingTable (
+    _In_ PSIMREP_MAPPING_TABLE MappingTable
+    )
+/*++
+
+Routine Description:
+
+    This routine releases a reference to a mapping table, freeing it when
+    the last reference goes away.
+
+Arguments:
+
+    MappingTable - The mapping table.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    if (InterlockedDecrement( &MappingTable->RefCount ) == 0) {
+
+        ExFreePoolWithTag( MappingTable, SIMREP_MAPPING_TAG );
+    }
+}
+
+
+VOID
+SimRepSwapMappingTable (
+    _In_opt_ PSIMREP_MAPPING_TABLE NewMappingTable
+    )
+/*++
+
+Routine Description:
+
+    This routine makes NewMappingTable the current mapping table.  Operations
+    which already referenced the previous table keep using it until they are
+    done; it is freed after the last of them.
+
+Arguments:
+
+    NewMappingTable - The new mapping table.  Its reference is transferred
+                      to Globals.MappingTable.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PSIMREP_MAPPING_TABLE oldMappingTable;
+
+    PAGED_CODE();
+
+    FltAcquirePushLockExclusive( &Globals.MappingTableLock );
+
+    oldMappingTable = Globals.MappingTable;
+    Globals.MappingTable = NewMappingTable;
+
+    FltReleasePushLock( &Globals.MappingTableLock );
+
+    if (oldMappingTable != NULL) {
+
+        SimRepDereferenceMappingTable( oldMappingTable );
+    }
+}
+
+
+//
+//  Configuration change routines.
+//
+//  SimRep keeps its registry key open and asks to be notified when a value
+//  under it changes.  The registry queues ConfigurationChangeWorkItem when
+//  that happens, and the worker rebuilds the mapping table and swaps it in.
+//  Note that RemapRenamesAndLinks is only read at load time because it
+//  decides which callbacks are registered.
+//
+
+NTSTATUS
+SimRepArmConfigurationWatch (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    This routine asks for a notification the next time a value under the
+    configuration key changes.  The caller holds ConfigurationLock.
+
+Return Value:
+
+    The status of ZwNotifyChangeKey.
+
+--*/
+{
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    KeClearEvent( &Globals.ConfigurationWatchStopped );
+
+    status = ZwNotifyChangeKey( Globals.ConfigurationKey,
+                                NULL,
+                                (PIO_APC_ROUTINE)(ULONG_PTR)&Globals.ConfigurationChangeWorkItem,
+                                (PVOID)(UINT_PTR)(unsigned int)DelayedWorkQueue,
+                                &Globals.ConfigurationChangeIoStatus,
+                                REG_NOTIFY_CHANGE_LAST_SET,
+                                FALSE,
+                                NULL,
+                                0,
+                                TRUE );
+
+    if (NT_SUCCESS( status )) {
+
+        Globals.ConfigurationWatchActive = TRUE;
+
+    } else {
+
+        DebugTrace( DEBUG_TRACE_ERROR,
+                    ("[SimRep]: SimRepArmConfigurationWatch -> Failed to watch the configuration key (Status = 0x%08X)\n",
+                     status) );
+
+        KeSetEvent( &Globals.ConfigurationWatchStopped, IO_NO_INCREMENT, FALSE );
+    }
+
+    return status;
+}
+
+
+VOID
+SimRepConfigurationChangeWorker (
+    _In_ PVOID Parameter
+    )
+/*++
+
+Routine Description:
+
+    This routine runs when the configuration key changed, or when it was
+    closed at unload.  It reads the mappings again and swaps in the new
+    table, then watches the key for the next change.
+
+    If the new configuration is not valid, the current table stays in use.
+
+Arguments:
+
+    Parameter - Unused.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    NTSTATUS status;
+    PSIMREP_MAPPING_TABLE mappingTable;
+
+    UNREFERENCED_PARAMETER( Parameter );
+
+    PAGED_CODE();
+
+    FltAcquirePushLockExclusive( &Globals.ConfigurationLock );
+
+    Globals.ConfigurationWatchActive = FALSE;
+
+    if (!Globals.Unloading) {
+
+        status = SimRepReadMappingTable( Globals.ConfigurationKey,
+                                         &mappingTable );
+
+        if (NT_SUCCESS( status )) {
+
+            DebugTrace( DEBUG_TRACE_LOAD_UNLOAD,
+                        ("[SimRep]: SimRepConfigurationChangeWorker -> Switching to %u mappings\n",
+                         mappingTable->MappingCount) );
+
+            SimRepSwapMappingTable( mappingTable );
+
+        } else {
+
+            DebugTrace( DEBUG_TRACE_ERROR,
+                        ("[SimRep]: SimRepConfigurationChangeWorker -> Keeping the current mappings, the new configuration is not valid (Status = 0x%08X)\n",
+                         status) );
+        }
+
+        SimRepArmConfigurationWatch();
+    }
+
+    if (!Globals.ConfigurationWatchActive) {
+
+        KeSetEvent( &Globals.ConfigurationWatchStopped, IO_NO_INCREMENT, FALSE );
+    }
+
+    FltReleasePushLock( &Globals.ConfigurationLock );
+}
+
+
+VOID
+SimRepStopConfigurationWatch (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    This routine closes the configuration key and waits until no change
+    notification is pending anymore.  Closing the key completes a pending
+    notification, which runs the worker one last time.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    if (Globals.ConfigurationKey == NULL) {
+
+        return;
+    }
+
+    FltAcquirePushLockExclusive( &Globals.ConfigurationLock );
+
+    Globals.Unloading = TRUE;
+
+    ZwClose( Globals.ConfigurationKey );
+    Globals.ConfigurationKey = NULL;
+
+    FltReleasePushLock( &Globals.ConfigurationLock );
+
+    KeWaitForSingleObject( &Globals.ConfigurationWatchStopped,
+                           Executive,
+                           KernelMode,
+                           FALSE,
+                           NULL );
+}
+
+
 //
 //  In order to remap renames and hard links correctly SimRep needs
 //  to be called as part of name resolution. To achieve this SimRep
@@ -0,0 +1,315 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All Rights Reserved
+
+Module Name:
+
+    swapXorBench.c
+
+Abstract:
+
+    A benchmark for the XOR transform routines of the swapBuffers sample.
+
+    SwapSelectTransform picks SwapXorTransformGeneric, Sse2, Avx2 or Neon
+    for the processor.  The benchmark times every version the processor
+    can run over a range of buffer lengths, at a key aligned and at an odd
+    file offset, and checks that each gives the same output as the generic
+    version.
+
+    It builds swapXor.c from the filter directory, so it runs the same
+    code the filter does.  In user mode SwapXorTransformAvx2 does not save
+    the AVX state, so its numbers leave out what KeSaveExtendedProcessorState
+    costs the filter; SWAP_AVX2_MIN_LENGTH is there for that cost.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_code_)
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "swapXor.h"
+
+#define DEFAULT_MILLISECONDS    200
+
+typedef struct _BENCH_ROUTINE {
+
+    PCSTR Name;
+    PSWAP_TRANSFORM_ROUTINE Routine;
+    BOOLEAN Present;
+
+} BENCH_ROUTINE, *PBENCH_ROUTINE;
+
+//
+//  The generic routine comes first; it is the one the others are checked
+//  and compared against.
+//
+
+BENCH_ROUTINE Routines[] = {
+    { "Generic", SwapXorTransformGeneric, TRUE },
+#if defined(_M_AMD64)
+    { "Sse2",    SwapXorTransformSse2,    TRUE },
+    { "Avx2",    SwapXorTransformAvx2,    FALSE },
+#endif
+#if defined(_M_ARM64)
+    { "Neon",    SwapXorTransformNeon,    TRUE },
+#endif
+};
+
+//
+//  Lengths the filter sees: a sector, a page, a typical noncached read,
+//  and a large paging write.
+//
+
+const ULONG Lengths[] = { 512, 1000, 4096, 65536, 1024 * 1024 };
+
+//
+//  A key aligned offset, and an odd one which makes every routine start
+//  in the middle of the key.
+//
+
+const LONGLONG Offsets[] = { 0, 7 };
+
+LARGE_INTEGER Frequency;
+
+
+VOID
+FillBuffer (
+    _Out_writes_bytes_(Length) PUCHAR Buffer,
+    _In_ ULONG Length
+    )
+{
+    ULONG Seed = 0x12345678;
+    ULONG i;
+
+    for (i = 0; i < Length; i++) {
+
+        Seed = Seed * 1664525 + 1013904223;
+        Buffer[i] = (UCHAR)(Seed >> 24);
+    }
+}
+
+
+BOOLEAN
+CheckRoutine (
+    _In_ PBENCH_ROUTINE Routine,
+    _In_ ULONG Length,
+    _In_ LONGLONG Offset,
+    _Inout_updates_bytes_(Length) PUCHAR Expected,
+    _Inout_updates_bytes_(Length) PUCHAR Actual
+    )
+
+/*++
+
+Routine Description:
+
+    Transforms the same data with Routine and with the generic routine and
+    compares the results byte for byte.  Transforms it a second time with
+    Routine to check that it is its own inverse.
+
+--*/
+
+{
+    FillBuffer( Expected, Length );
+    FillBuffer( Actual, Length );
+
+    SwapXorTransformGeneric( Expected, Length, Offset );
+    Routine->Routine( Actual, Length, Offset );
+
+    if (memcmp( Expected, Actual, Length ) != 0) {
+
+        return FALSE;
+    }
+
+    Routine->Routine( Actual, Length, Offset );
+    FillBuffer( Expected, Length );
+
+    return (memcmp( Expected, Actual, Length ) == 0);
+}
+
+
+double
+TimeRoutine (
+    _In_ PBENCH_ROUTINE Routine,
+    _In_ ULONG Length,
+    _In_ LONGLONG Offset,
+    _Inout_updates_bytes_(Length) PUCHAR Buffer,
+    _In_ ULONG Milliseconds
+    )
+
+/*++
+
+Routine Description:
+
+    Returns the average time of one call in nanoseconds.
+
+--*/
+
+{
+    LARGE_INTEGER Start;
+    LARGE_INTEGER Now;
+    LONGLONG Budget;
+    ULONGLONG Calls = 0;
+    ULONG i;
+
+    //
+    //  Warm up the caches and the branch predictors.
+    //
+
+    for (i = 0; i < 16; i++) {
+
+        Routine->Routine( Buffer, Length, Offset );
+    }
+
+    Budget = Frequency.QuadPart * Milliseconds / 1000;
+
+    QueryPerformanceCounter( &Start );
+
+    do {
+
+        for (i = 0; i < 16; i++) {
+
+            Routine->Routine( Buffer, Length, Offset );
+        }
+
+        Calls += 16;
+
+        QueryPerformanceCounter( &Now );
+
+    } while (Now.QuadPart - Start.QuadPart < Budget);
+
+    return (double)(Now.QuadPart - Start.QuadPart) * 1e9 / (double)Frequency.QuadPart / (double)Calls;
+}
+
+
+VOID
+Usage (
+    VOID
+    )
+{
+    printf( "Usage: swapXorBench [-Milliseconds <n>]\n" );
+    printf( "    -Milliseconds   time spent on each case (default %d)\n", DEFAULT_MILLISECONDS );
+}
+
+
+int
+__cdecl
+main (
+    _In_ int argc,
+    _In_reads_(argc) char *argv[]
+    )
+{
+    ULONG Milliseconds = DEFAULT_MILLISECONDS;
+    PUCHAR Expected;
+    PUCHAR Actual;
+    int Argument;
+    int Failures = 0;
+    ULONG l, o, r;
+    double Baseline;
+    double Time;
+
+    for (Argument = 1; Argument < argc; Argument++) {
+
+        if ((_stricmp( argv[Argument], "-Milliseconds" ) == 0) && (Argument + 1 < argc)) {
+
+            Milliseconds = strtoul( argv[++Argument], NULL, 0 );
+
+        } else {
+
+            Usage();
+            return 1;
+        }
+    }
+
+    if (Milliseconds == 0) {
+
+        Usage();
+        return 1;
+    }
+
+#if defined(_M_AMD64) && defined(PF_AVX2_INSTRUCTIONS_AVAILABLE)
+
+    Routines[2].Present = (BOOLEAN)IsProcessorFeaturePresent( PF_AVX2_INSTRUCTIONS_AVAILABLE );
+
+#endif
+
+    Expected = VirtualAlloc( NULL, Lengths[ARRAYSIZE( Lengths ) - 1], MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE );
+    Actual = VirtualAlloc( NULL, Lengths[ARRAYSIZE( Lengths ) - 1], MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE );
+
+    if ((Expected == NULL) || (Actual == NULL)) {
+
+        printf( "Out of memory\n" );
+        return 1;
+    }
+
+    SwapXorInitializeKeyStream();
+
+    QueryPerformanceFrequency( &Frequency );
+
+    //
+    //  Keep the timing thread on one processor and ahead of the rest of
+    //  the system.
+    //
+
+    SetThreadAffinityMask( GetCurrentThread(), 1 );
+    SetThreadPriority( GetCurrentThread(), THREAD_PRIORITY_HIGHEST );
+
+    printf( "%-8s %8s %6s %12s %8s %8s\n",
+            "Routine", "Length", "Offset", "ns/call", "GB/s", "vs C" );
+
+    for (l = 0; l < ARRAYSIZE( Lengths ); l++) {
+
+        for (o = 0; o < ARRAYSIZE( Offsets ); o++) {
+
+            Baseline = 0.0;
+
+            for (r = 0; r < ARRAYSIZE( Routines ); r++) {
+
+                if (!Routines[r].Present) {
+
+                    continue;
+                }
+
+                if ((r > 0) && !CheckRoutine( &Routines[r], Lengths[l], Offsets[o], Expected, Actual )) {
+
+                    printf( "%-8s %8u %6I64d    MISMATCH against the generic routine\n",
+                            Routines[r].Name, Lengths[l], Offsets[o] );
+                    Failures++;
+                    continue;
+                }
+
+                Time = TimeRoutine( &Routines[r], Lengths[l], Offsets[o], Actual, Milliseconds );
+
+                if (r == 0) {
+
+                    Baseline = Time;
+                }
+
+                printf( "%-8s %8u %6I64d %12.1f %8.2f %7.2fx\n",
+                        Routines[r].Name,
+                        Lengths[l],
+                        Offsets[o],
+                        Time,
+                        Lengths[l] / Time,
+                        Baseline / Time );
+            }
+        }
+    }
+
+    VirtualFree( Expected, 0, MEM_RELEASE );
+    VirtualFree( Actual, 0, MEM_RELEASE );
+
+    if (Failures != 0) {
+
+        printf( "\n%d routine checks failed\n", Failures );
+        return 2;
+    }
+
+    return 0;
+}
@@ -29,6 +29,8 @@ Environment:
 #include <dontuse.h>
 #include <suppress.h>
 
+#include "swapXor.h"
+
 #pragma prefast(disable:__WARNING_ENCODE_MEMBER_FUNCTION_POINTER, "Not valid for kernel mode drivers")
 
 
@@ -42,6 +44,7 @@ PFLT_FILTER gFilterHandle;
 #define CONTEXT_TAG         'xcBS'
 #define NAME_TAG            'mnBS'
 #define PRE_2_POST_TAG      'ppBS'
+#define BUFFER_POOL_TAG     'plBS'
 
 /*************************************************************************
     Local structures
@@ -95,6 +98,12 @@ typedef struct _PRE_2_POST_CONTEXT {
 
     PVOID SwappedBuffer;
 
+    //
+    //  The SwapAllocateBuffer class of SwappedBuffer.
+    //
+
+    ULONG SwappedBufferClass;
+
 } PRE_2_POST_CONTEXT, *PPRE_2_POST_CONTEXT;
 
 //
@@ -103,6 +112,56 @@ typedef struct _PRE_2_POST_CONTEXT {
 
 NPAGED_LOOKASIDE_LIST Pre2PostContextList;
 
+//
+//  Read and write buffers are reused from per-processor pools of a few
+//  size classes instead of being allocated for every operation.  Note that
+//  the MDLs can't be kept with the buffers: FltMgr frees the MDL we swap
+//  in when the operation completes.
+//
+
+#define SWAP_BUFFER_CLASS_COUNT     3
+#define SWAP_BUFFER_CLASS_NONE      ((ULONG)-1)     // allocated directly
+#define SWAP_BUFFER_CLASS_RESERVE   ((ULONG)-2)     // taken from the reserve
+
+#define SWAP_BUFFER_POOL_DEPTH      32              // per processor and class
+#define SWAP_BUFFER_RESERVE_COUNT   4               // of the largest class
+
+const ULONG SwapBufferClassSize[SWAP_BUFFER_CLASS_COUNT] = {
+    PAGE_SIZE,
+    16 * 1024,
+    64 * 1024
+};
+
+typedef struct DECLSPEC_CACHEALIGN _SWAP_BUFFER_POOL {
+
+    //
+    //  Free buffers of each size class.
+    //
+
+    SLIST_HEADER FreeList[SWAP_BUFFER_CLASS_COUNT];
+
+    //
+    //  Allocations served from the pool and from system pool.
+    //
+
+    LONG Hits;
+    LONG Misses;
+
+} SWAP_BUFFER_POOL, *PSWAP_BUFFER_POOL;
+
+PSWAP_BUFFER_POOL SwapBufferPools;
+ULONG SwapBufferPoolCount;
+
+//
+//  Buffers of the largest class kept so operations can still be swapped
+//  when the system is out of nonPaged pool.
+//
+
+SLIST_HEADER SwapBufferReserve;
+
+LONG SwapBufferReserveUses;
+LONG SwapBufferOversized;
+
 /*************************************************************************
     Prototypes
 *************************************************************************/
@@ -162,6 +221,14 @@ SwapPostReadBuffersWhenSafe (
     _In_ FLT_POST_OPERATION_FLAGS Flags
     );
 
+FLT_POSTOP_CALLBACK_STATUS
+SwapPostReadBuffersInPlace (
+    _Inout_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ PVOID CompletionContext,
+    _In_ FLT_POST_OPERATION_FLAGS Flags
+    );
+
 FLT_PREOP_CALLBACK_STATUS
 SwapPreDirCtrlBuffers(
     _Inout_ PFLT_CALLBACK_DATA Data,
@@ -205,6 +272,43 @@ ReadDriverParameters (
     _In_ PUNICODE_STRING RegistryPath
     );
 
+VOID
+SwapTransformData (
+    _Inout_updates_bytes_(Length) PVOID Buffer,
+    _In_ ULONG Length,
+    _In_ LONGLONG FileOffset,
+    _In_ BOOLEAN ToDisk
+    );
+
+VOID
+SwapSelectTransform (
+    VOID
+    );
+
+NTSTATUS
+SwapInitializeBufferPool (
+    VOID
+    );
+
+VOID
+SwapDeleteBufferPool (
+    VOID
+    );
+
+PVOID
+SwapAllocateBuffer (
+    _In_ PFLT_INSTANCE Instance,
+    _In_ ULONG Length,
+    _Out_ PULONG BufferClass
+    );
+
+VOID
+SwapFreeBuffer (
+    _In_ PFLT_INSTANCE Instance,
+    _In_ PVOID Buffer,
+    _In_ ULONG BufferClass
+    );
+
 //
 //  Assign text sections for each routine.
 //
@@ -216,6 +320,9 @@ ReadDriverParameters (
 #pragma alloc_text(INIT, DriverEntry)
 #pragma alloc_text(INIT, ReadDriverParameters)
 #pragma alloc_text(PAGE, FilterUnload)
+#pragma alloc_text(INIT, SwapInitializeBufferPool)
+#pragma alloc_text(PAGE, SwapDeleteBufferPool)
+#pragma alloc_text(INIT, SwapSelectTransform)
 #endif
 
 //
@@ -299,6 +406,8 @@ CONST FLT_REGISTRATION FilterRegistration = {
 #define LOGFL_WRITE     0x00000004  // if set, display WRITE operation info
 #define LOGFL_DIRCTRL   0x00000008  // if set, display DIRCTRL operation info
 #define LOGFL_VOLCTX    0x00000010  // if set, display VOLCTX operation info
+#define LOGFL_POOL      0x00000020  // if set, display buffer pool statistics
+#define LOGFL_TRANSFORM 0x00000040  // if set, display the transform routine picked
 
 ULONG LoggingFlags = 0;             // all disabled by default
 
@@ -307,6 +416,60 @@ ULONG LoggingFlags = 0;             // all disabled by default
         DbgPrint _string  :                                         \
         ((int)0))
 
+/*************************************************************************
+    Swap mode
+*************************************************************************/
+
+//
+//  The registry DWORD entry:
+//  "hklm\system\CurrentControlSet\Services\Swapbuffers\SwapMode" selects
+//  how data is transformed:
+//
+//  SWAP_MODE_DOUBLE_BUFFER - every read and write is swapped to a buffer of
+//      our own and transformed there.
+//
+//  SWAP_MODE_IN_PLACE - noncached paging reads are not swapped, the data is
+//      transformed in the pages they complete into.  Nobody can see those
+//      pages before the read completes, so this saves the copy.  Writes are
+//      still swapped: transforming the caller's pages in place would
+//      corrupt data written to a mapped page while the write is in flight.
+//
+
+#define SWAP_MODE_DOUBLE_BUFFER     0
+#define SWAP_MODE_IN_PLACE          1
+
+ULONG SwapMode = SWAP_MODE_DOUBLE_BUFFER;
+
+/*************************************************************************
+    Transforms
+*************************************************************************/
+
+//
+//  The registry DWORD entry:
+//  "hklm\system\CurrentControlSet\Services\Swapbuffers\Transform" selects
+//  the transform applied to the data:
+//
+//  SWAP_TRANSFORM_NONE - the data is left unchanged.
+//
+//  SWAP_TRANSFORM_XOR - the data is XORed with a key repeating every
+//      SWAP_XOR_KEY_SIZE bytes of the file.  This stands in for a real
+//      cipher to show how a transform and its processor specific versions
+//      plug in; it does not protect anything.  Files are only readable
+//      through the filter once they were written through it.
+//
+
+#define SWAP_TRANSFORM_NONE         0
+#define SWAP_TRANSFORM_XOR          1
+
+ULONG SwapTransform = SWAP_TRANSFORM_NONE;
+
+//
+//  The version of the transform picked for this processor, NULL for
+//  SWAP_TRANSFORM_NONE.
+//
+
+PSWAP_TRANSFORM_ROUTINE SwapTransformRoutine = NULL;
+
 //////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -680,6 +843,12 @@ Return Value:
 
     ReadDriverParameters( RegistryPath );
 
+    //
+    //  Pick the version of the transform to use on this processor
+    //
+
+    SwapSelectTransform();
+
     //
     //  Init lookaside list used to allocate our context structure used to
     //  pass information from out preOperation callback to our postOperation
@@ -694,6 +863,17 @@ Return Value:
                                      PRE_2_POST_TAG,
                                      0 );
 
+    //
+    //  Init the pools we allocate our swap buffers from.
+    //
+
+    status = SwapInitializeBufferPool();
+
+    if (! NT_SUCCESS( status )) {
+
+        goto SwapDriverEntryExit;
+    }
+
     //
     //  Register with FltMgr
     //
@@ -723,6 +903,7 @@ SwapDriverEntryExit:
 
     if(! NT_SUCCESS( status )) {
 
+        SwapDeleteBufferPool();
         ExDeleteNPagedLookasideList( &Pre2PostContextList );
     }
 
@@ -762,15 +943,305 @@ Return Value:
     FltUnregisterFilter( gFilterHandle );
 
     //
-    //  Delete lookaside list
+    //  Free the pooled buffers and delete lookaside list
     //
 
+    SwapDeleteBufferPool();
     ExDeleteNPagedLookasideList( &Pre2PostContextList );
 
     return STATUS_SUCCESS;
 }
 
 
+/*************************************************************************
+    Swap buffer pool routines.
+*************************************************************************/
+
+NTSTATUS
+SwapInitializeBufferPool (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    This routine allocates the per-processor swap buffer pools and fills
+    the reserve.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    Status of the operation
+
+--*/
+{
+    ULONG i, j;
+    PVOID buffer;
+
+    SwapBufferPoolCount = KeQueryMaximumProcessorCountEx( ALL_PROCESSOR_GROUPS );
+
+    SwapBufferPools = ExAllocatePoolWithTag( NonPagedPool,
+                                             SwapBufferPoolCount * sizeof(SWAP_BUFFER_POOL),
+                                             BUFFER_POOL_TAG );
+
+    if (SwapBufferPools == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory( SwapBufferPools,
+                   SwapBufferPoolCount * sizeof(SWAP_BUFFER_POOL) );
+
+    for (i = 0; i < SwapBufferPoolCount; i++) {
+
+        for (j = 0; j < SWAP_BUFFER_CLASS_COUNT; j++) {
+
+            InitializeSListHead( &SwapBufferPools[i].FreeList[j] );
+        }
+    }
+
+    InitializeSListHead( &SwapBufferReserve );
+
+    for (i = 0; i < SWAP_BUFFER_RESERVE_COUNT; i++) {
+
+        buffer = ExAllocatePoolWithTag( NonPagedPool,
+                                        SwapBufferClassSize[SWAP_BUFFER_CLASS_COUNT - 1],
+                                        BUFFER_SWAP_TAG );
+
+        if (buffer == NULL) {
+
+            SwapDeleteBufferPool();
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        InterlockedPushEntrySList( &SwapBufferReserve, buffer );
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+SwapDeleteBufferPool (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    This routine frees all pooled and reserved swap buffers.  It is called
+    once no more I/O can be outstanding.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+{
+    PSLIST_ENTRY entry;
+    ULONG i, j;
+
+    PAGED_CODE();
+
+    if (SwapBufferPools != NULL) {
+
+        for (i = 0; i < SwapBufferPoolCount; i++) {
+
+            LOG_PRINT( LOGFL_POOL,
+                       ("SwapBuffers!SwapDeleteBufferPool:           Processor %d hits=%d misses=%d\n",
+                        i,
+                        SwapBufferPools[i].Hits,
+                        SwapBufferPools[i].Misses) );
+
+            for (j = 0; j < SWAP_BUFFER_CLASS_COUNT; j++) {
+
+                while ((entry = InterlockedPopEntrySList( &SwapBufferPools[i].FreeList[j] )) != NULL) {
+
+                    ExFreePoolWithTag( entry, BUFFER_SWAP_TAG );
+                }
+            }
+        }
+
+        ExFreePoolWithTag( SwapBufferPools, BUFFER_POOL_TAG );
+        SwapBufferPools = NULL;
+    }
+
+    LOG_PRINT( LOGFL_POOL,
+               ("SwapBuffers!SwapDeleteBufferPool:           reserveUses=%d oversized=%d\n",
+                SwapBufferReserveUses,
+                SwapBufferOversized) );
+
+    while ((entry = InterlockedPopEntrySList( &SwapBufferReserve )) != NULL) {
+
+        ExFreePoolWithTag( entry, BUFFER_SWAP_TAG );
+    }
+}
+
+
+PVOID
+SwapAllocateBuffer (
+    _In_ PFLT_INSTANCE Instance,
+    _In_ ULONG Length,
+    _Out_ PULONG BufferClass
+    )
+/*++
+
+Routine Description:
+
+    This routine gets a nonPaged buffer to swap to.  Buffers up to the
+    largest size class come from the current processor's pool, and from
+    the reserve if the system is out of memory.  Larger buffers are
+    allocated directly.
+
+    All pooled buffers are at least a page long, so they are page aligned
+    and meet the alignment requirement of any device.
+
+Arguments:
+
+    Instance - The instance the buffer is used on.
+
+    Length - The required length of the buffer.
+
+    BufferClass - Receives the value to pass to SwapFreeBuffer.
+
+Return Value:
+
+    The buffer, or NULL if none could be allocated.
+
+--*/
+{
+    PSWAP_BUFFER_POOL pool;
+    PVOID buffer;
+    ULONG sizeClass;
+
+    for (sizeClass = 0; class < SWAP_BUFFER_CLASS_COUNT; class++) {
+
+        if (Length <= SwapBufferClassSize[sizeClass]) {
+
+            break;
+        }
+    }
+
+    if (sizeClass == SWAP_BUFFER_CLASS_COUNT) {
+
+        InterlockedIncrement( &SwapBufferOversized );
+
+        *BufferClass = SWAP_BUFFER_CLASS_NONE;
+
+        return FltAllocatePoolAlignedWithTag( Instance,
+                                              NonPagedPool,
+                                              (SIZE_T) Length,
+                                              BUFFER_SWAP_TAG );
+    }
+
+    pool = &SwapBufferPools[KeGetCurrentProcessorNumberEx( NULL )];
+
+    buffer = InterlockedPopEntrySList( &pool->FreeList[sizeClass] );
+
+    if (buffer != NULL) {
+
+        InterlockedIncrement( &pool->Hits );
+        *BufferClass = sizeClass;
+        return buffer;
+    }
+
+    InterlockedIncrement( &pool->Misses );
+
+    buffer = ExAllocatePoolWithTag( NonPagedPool,
+                                    SwapBufferClassSize[sizeClass],
+                                    BUFFER_SWAP_TAG );
+
+    if (buffer != NULL) {
+
+        *BufferClass = sizeClass;
+        return buffer;
+    }
+
+    //
+    //  We are low on memory, use the reserve so the operation still gets
+    //  its buffer swapped.
+    //
+
+    buffer = InterlockedPopEntrySList( &SwapBufferReserve );
+
+    if (buffer != NULL) {
+
+        InterlockedIncrement( &SwapBufferReserveUses );
+    }
+
+    *BufferClass = SWAP_BUFFER_CLASS_RESERVE;
+    return buffer;
+}
+
+
+VOID
+SwapFreeBuffer (
+    _In_ PFLT_INSTANCE Instance,
+    _In_ PVOID Buffer,
+    _In_ ULONG BufferClass
+    )
+/*++
+
+Routine Description:
+
+    This routine returns a buffer from SwapAllocateBuffer.  It may be called
+    at DPC level.
+
+Arguments:
+
+    Instance - The instance the buffer was allocated for.
+
+    Buffer - The buffer to free.
+
+    BufferClass - The class returned by SwapAllocateBuffer.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PSWAP_BUFFER_POOL pool;
+
+    if (BufferClass == SWAP_BUFFER_CLASS_NONE) {
+
+        FltFreePoolAlignedWithTag( Instance,
+                                   Buffer,
+                                   BUFFER_SWAP_TAG );
+        return;
+    }
+
+    if (BufferClass == SWAP_BUFFER_CLASS_RESERVE) {
+
+        InterlockedPushEntrySList( &SwapBufferReserve, Buffer );
+        return;
+    }
+
+    //
+    //  Cache the buffer on the processor we complete on, unless that pool
+    //  already holds enough of them.
+    //
+
+    pool = &SwapBufferPools[KeGetCurrentProcessorNumberEx( NULL )];
+
+    if (ExQueryDepthSList( &pool->FreeList[BufferClass] ) < SWAP_BUFFER_POOL_DEPTH) {
+
+        InterlockedPushEntrySList( &pool->FreeList[BufferClass], Buffer );
+
+    } else {
+
+        ExFreePoolWithTag( Buffer, BUFFER_SWAP_TAG );
+    }
+}
+
+
 /*************************************************************************
     MiniFilter callback routines.
 *************************************************************************/
@@ -810,6 +1281,7 @@ Return Value:
     PFLT_IO_PARAMETER_BLOCK iopb = Data->Iopb;
     FLT_PREOP_CALLBACK_STATUS retValue = FLT_PREOP_SUCCESS_NO_CALLBACK;
     PVOID newBuf = NULL;
+    ULONG newBufClass = SWAP_BUFFER_CLASS_NONE;
     PMDL newMdl = NULL;
     PVOLUME_CONTEXT volCtx = NULL;
     PPRE_2_POST_CONTEXT p2pCtx;
@@ -846,6 +1318,43 @@ Return Value:
             leave;
         }
 
+        //
+        //  In the in place mode we don't swap noncached paging reads, the
+        //  post-operation callback transforms the data where it was read.
+        //
+
+        if ((SwapMode == SWAP_MODE_IN_PLACE) &&
+            FlagOn(IRP_PAGING_IO,iopb->IrpFlags) &&
+            FlagOn(IRP_NOCACHE,iopb->IrpFlags) &&
+            (iopb->Parameters.Read.MdlAddress != NULL)) {
+
+            p2pCtx = ExAllocateFromNPagedLookasideList( &Pre2PostContextList );
+
+            if (p2pCtx == NULL) {
+
+                LOG_PRINT( LOGFL_ERRORS,
+                           ("SwapBuffers!SwapPreReadBuffers:             %wZ Failed to allocate pre2Post context structure\n",
+                            &volCtx->Name) );
+
+                leave;
+            }
+
+            LOG_PRINT( LOGFL_READ,
+                       ("SwapBuffers!SwapPreReadBuffers:             %wZ in place oldMdl=%p len=%d\n",
+                        &volCtx->Name,
+                        iopb->Parameters.Read.MdlAddress,
+                        readLen) );
+
+            p2pCtx->SwappedBuffer = NULL;
+            p2pCtx->SwappedBufferClass = SWAP_BUFFER_CLASS_NONE;
+            p2pCtx->VolCtx = volCtx;
+
+            *CompletionContext = p2pCtx;
+
+            retValue = FLT_PREOP_SUCCESS_WITH_CALLBACK;
+            leave;
+        }
+
         //
         //  If this is a non-cached I/O we need to round the length up to the
         //  sector size for this device.  We must do this because the file
@@ -859,16 +1368,15 @@ Return Value:
         }
 
         //
-        //  Allocate aligned nonPaged memory for the buffer we are swapping
+        //  Get aligned nonPaged memory for the buffer we are swapping
         //  to. This is really only necessary for noncached IO but we always
         //  do it here for simplification. If we fail to get the memory, just
         //  don't swap buffers on this operation.
         //
 
-        newBuf = FltAllocatePoolAlignedWithTag( FltObjects->Instance, 
-                                                NonPagedPool,
-                                                (SIZE_T) readLen,
-                                                BUFFER_SWAP_TAG );
+        newBuf = SwapAllocateBuffer( FltObjects->Instance,
+                                     readLen,
+                                     &newBufClass );
         if (newBuf == NULL) {
 
             LOG_PRINT( LOGFL_ERRORS,
@@ -958,6 +1466,7 @@ Return Value:
         //
 
         p2pCtx->SwappedBuffer = newBuf;
+        p2pCtx->SwappedBufferClass = newBufClass;
         p2pCtx->VolCtx = volCtx;
 
         *CompletionContext = p2pCtx;
@@ -978,9 +1487,9 @@ Return Value:
 
             if (newBuf != NULL) {
 
-                FltFreePoolAlignedWithTag( FltObjects->Instance,
-                                           newBuf,
-                                           BUFFER_SWAP_TAG );
+                SwapFreeBuffer( FltObjects->Instance,
+                                newBuf,
+                                newBufClass );
             }
 
             if (newMdl != NULL) {
@@ -1044,6 +1553,18 @@ Return Value:
 
     FLT_ASSERT(!FlagOn(Flags, FLTFL_POST_OPERATION_DRAINING));
 
+    //
+    //  See if the pre-operation callback left the read unswapped.
+    //
+
+    if (p2pCtx->SwappedBuffer == NULL) {
+
+        return SwapPostReadBuffersInPlace( Data,
+                                           FltObjects,
+                                           CompletionContext,
+                                           Flags );
+    }
+
     try {
 
         //
@@ -1171,6 +1692,14 @@ Return Value:
         //  exception.
         //
 
+        if (FlagOn(IRP_NOCACHE,iopb->IrpFlags)) {
+
+            SwapTransformData( p2pCtx->SwappedBuffer,
+                               (ULONG) Data->IoStatus.Information,
+                               iopb->Parameters.Read.ByteOffset.QuadPart,
+                               FALSE );
+        }
+
         try {
 
             RtlCopyMemory( origBuf,
@@ -1209,9 +1738,9 @@ Return Value:
                         p2pCtx->SwappedBuffer,
                         Data->IoStatus.Information) );
 
-            FltFreePoolAlignedWithTag( FltObjects->Instance,
-                                       p2pCtx->SwappedBuffer,
-                                       BUFFER_SWAP_TAG );
+            SwapFreeBuffer( FltObjects->Instance,
+                            p2pCtx->SwappedBuffer,
+                            p2pCtx->SwappedBufferClass );
 
             FltReleaseContext( p2pCtx->VolCtx );
 
@@ -1318,6 +1847,14 @@ Return Value:
             //  buffer address.
             //
 
+            if (FlagOn(IRP_NOCACHE,iopb->IrpFlags)) {
+
+                SwapTransformData( p2pCtx->SwappedBuffer,
+                                   (ULONG) Data->IoStatus.Information,
+                                   iopb->Parameters.Read.ByteOffset.QuadPart,
+                                   FALSE );
+            }
+
             RtlCopyMemory( origBuf,
                            p2pCtx->SwappedBuffer,
                            Data->IoStatus.Information );
@@ -1334,9 +1871,94 @@ Return Value:
                 p2pCtx->SwappedBuffer,
                 Data->IoStatus.Information) );
 
-    FltFreePoolAlignedWithTag( FltObjects->Instance,
-                               p2pCtx->SwappedBuffer,
-                               BUFFER_SWAP_TAG );
+    SwapFreeBuffer( FltObjects->Instance,
+                    p2pCtx->SwappedBuffer,
+                    p2pCtx->SwappedBufferClass );
+
+    FltReleaseContext( p2pCtx->VolCtx );
+
+    ExFreeToNPagedLookasideList( &Pre2PostContextList,
+                                 p2pCtx );
+
+    return FLT_POSTOP_FINISHED_PROCESSING;
+}
+
+
+FLT_POSTOP_CALLBACK_STATUS
+SwapPostReadBuffersInPlace (
+    _Inout_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ PVOID CompletionContext,
+    _In_ FLT_POST_OPERATION_FLAGS Flags
+    )
+/*++
+
+Routine Description:
+
+    This routine does postRead handling for a read that was not swapped
+    because of SWAP_MODE_IN_PLACE.  The data is transformed in the pages
+    it was read into.
+
+Arguments:
+
+    Data - Pointer to the filter callbackData that is passed to us.
+
+    FltObjects - Pointer to the FLT_RELATED_OBJECTS data structure containing
+        opaque handles to this filter, instance, its associated volume and
+        file object.
+
+    CompletionContext - The completion context set in the pre-operation routine.
+
+    Flags - Denotes whether the completion is successful or is being drained.
+
+Return Value:
+
+    FLT_POSTOP_FINISHED_PROCESSING - This is always returned.
+
+--*/
+{
+    PFLT_IO_PARAMETER_BLOCK iopb = Data->Iopb;
+    PPRE_2_POST_CONTEXT p2pCtx = CompletionContext;
+    PVOID origBuf;
+
+    UNREFERENCED_PARAMETER( FltObjects );
+    UNREFERENCED_PARAMETER( Flags );
+
+    if (NT_SUCCESS(Data->IoStatus.Status) &&
+        (Data->IoStatus.Information != 0)) {
+
+        //
+        //  Paging I/O always has a MDL, and mapping it is allowed at DPC
+        //  level.
+        //
+
+        origBuf = MmGetSystemAddressForMdlSafe( iopb->Parameters.Read.MdlAddress,
+                                                NormalPagePriority | MdlMappingNoExecute );
+
+        if (origBuf == NULL) {
+
+            LOG_PRINT( LOGFL_ERRORS,
+                       ("SwapBuffers!SwapPostReadBuffersInPlace:     %wZ Failed to get system address for MDL: %p\n",
+                        &p2pCtx->VolCtx->Name,
+                        iopb->Parameters.Read.MdlAddress) );
+
+            Data->IoStatus.Status = STATUS_INSUFFICIENT_RESOURCES;
+            Data->IoStatus.Information = 0;
+
+        } else {
+
+            LOG_PRINT( LOGFL_READ,
+                       ("SwapBuffers!SwapPostReadBuffersInPlace:     %wZ oldB=%p info=%Iu Transforming\n",
+                        &p2pCtx->VolCtx->Name,
+                        origBuf,
+                        Data->IoStatus.Information) );
+
+            SwapTransformData( origBuf,
+                               (ULONG) Data->IoStatus.Information,
+                               iopb->Parameters.Read.ByteOffset.QuadPart,
+                               FALSE );
+        }
+    }
 
     FltReleaseContext( p2pCtx->VolCtx );
 
@@ -1941,6 +2563,7 @@ Return Value:
     PFLT_IO_PARAMETER_BLOCK iopb = Data->Iopb;
     FLT_PREOP_CALLBACK_STATUS retValue = FLT_PREOP_SUCCESS_NO_CALLBACK;
     PVOID newBuf = NULL;
+    ULONG newBufClass = SWAP_BUFFER_CLASS_NONE;
     PMDL newMdl = NULL;
     PVOLUME_CONTEXT volCtx = NULL;
     PPRE_2_POST_CONTEXT p2pCtx;
@@ -1991,16 +2614,15 @@ Return Value:
         }
 
         //
-        //  Allocate aligned nonPaged memory for the buffer we are swapping
+        //  Get aligned nonPaged memory for the buffer we are swapping
         //  to. This is really only necessary for noncached IO but we always
         //  do it here for simplification. If we fail to get the memory, just
         //  don't swap buffers on this operation.
         //
 
-        newBuf = FltAllocatePoolAlignedWithTag( FltObjects->Instance, 
-                                                NonPagedPool,
-                                                (SIZE_T) writeLen,
-                                                BUFFER_SWAP_TAG );
+        newBuf = SwapAllocateBuffer( FltObjects->Instance,
+                                     writeLen,
+                                     &newBufClass );
 
         if (newBuf == NULL) {
 
@@ -2121,6 +2743,14 @@ Return Value:
             leave;
         }
 
+        if (FlagOn(IRP_NOCACHE,iopb->IrpFlags)) {
+
+            SwapTransformData( newBuf,
+                               writeLen,
+                               iopb->Parameters.Write.ByteOffset.QuadPart,
+                               TRUE );
+        }
+
         //
         //  We are ready to swap buffers, get a pre2Post context structure.
         //  We need it to pass the volume context and the allocate memory
@@ -2160,6 +2790,7 @@ Return Value:
         //
 
         p2pCtx->SwappedBuffer = newBuf;
+        p2pCtx->SwappedBufferClass = newBufClass;
         p2pCtx->VolCtx = volCtx;
 
         *CompletionContext = p2pCtx;
@@ -2181,9 +2812,9 @@ Return Value:
 
             if (newBuf != NULL) {
 
-                FltFreePoolAlignedWithTag( FltObjects->Instance,
-                                           newBuf,
-                                           BUFFER_SWAP_TAG );
+                SwapFreeBuffer( FltObjects->Instance,
+                                newBuf,
+                                newBufClass );
 
             }
 
@@ -2237,9 +2868,9 @@ Return Value:
     //  Free allocate POOL and volume context
     //
 
-    FltFreePoolAlignedWithTag( FltObjects->Instance,
-                               p2pCtx->SwappedBuffer,
-                               BUFFER_SWAP_TAG );
+    SwapFreeBuffer( FltObjects->Instance,
+                    p2pCtx->SwappedBuffer,
+                    p2pCtx->SwappedBufferClass );
 
     FltReleaseContext( p2pCtx->VolCtx );
 
@@ -2280,30 +2911,30 @@ Return Value:
     UCHAR buffer[sizeof( KEY_VALUE_PARTIAL_INFORMATION ) + sizeof( LONG )];
 
     //
-    //  If this value is not zero then somebody has already explicitly set it
-    //  so don't override those settings.
+    //  Open the desired registry key
     //
 
-    if (0 == LoggingFlags) {
+    InitializeObjectAttributes( &attributes,
+                                RegistryPath,
+                                OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                                NULL,
+                                NULL );
 
-        //
-        //  Open the desired registry key
-        //
+    status = ZwOpenKey( &driverRegKey,
+                        KEY_READ,
+                        &attributes );
 
-        InitializeObjectAttributes( &attributes,
-                                    RegistryPath,
-                                    OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
-                                    NULL,
-                                    NULL );
+    if (!NT_SUCCESS( status )) {
 
-        status = ZwOpenKey( &driverRegKey,
-                            KEY_READ,
-                            &attributes );
+        return;
+    }
 
-        if (!NT_SUCCESS( status )) {
+    //
+    //  If this value is not zero then somebody has already explicitly set it
+    //  so don't override those settings.
+    //
 
-            return;
-        }
+    if (0 == LoggingFlags) {
 
         //
         // Read the given value from the registry.
@@ -2322,12 +2953,149 @@ Return Value:
 
             LoggingFlags = *((PULONG) &(((PKEY_VALUE_PARTIAL_INFORMATION)buffer)->Data));
         }
+    }
 
-        //
-        //  Close the registry entry
-        //
+    RtlInitUnicodeString( &valueName, L"SwapMode" );
+
+    status = ZwQueryValueKey( driverRegKey,
+                              &valueName,
+                              KeyValuePartialInformation,
+                              buffer,
+                              sizeof(buffer),
+                              &resultLength );
+
+    if (NT_SUCCESS( status ) &&
+        (*((PULONG) &(((PKEY_VALUE_PARTIAL_INFORMATION)buffer)->Data)) == SWAP_MODE_IN_PLACE)) {
+
+        SwapMode = SWAP_MODE_IN_PLACE;
+    }
+
+    RtlInitUnicodeString( &valueName, L"Transform" );
+
+    status = ZwQueryValueKey( driverRegKey,
+                              &valueName,
+                              KeyValuePartialInformation,
+                              buffer,
+                              sizeof(buffer),
+                              &resultLength );
+
+    if (NT_SUCCESS( status ) &&
+        (*((PULONG) &(((PKEY_VALUE_PARTIAL_INFORMATION)buffer)->Data)) == SWAP_TRANSFORM_XOR)) {
+
+        SwapTransform = SWAP_TRANSFORM_XOR;
+    }
+
+    //
+    //  Close the registry entry
+    //
+
+    ZwClose(driverRegKey);
+}
+
+
+/*************************************************************************
+    Transform routines.
+*************************************************************************/
+
+VOID
+SwapSelectTransform (
+    VOID
+    )
+/*++
+
+Routine Description:
 
-        ZwClose(driverRegKey);
+    This routine picks the routine SwapTransformData uses for the configured
+    transform, based on the features of the processor.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    if (SwapTransform != SWAP_TRANSFORM_XOR) {
+
+        return;
+    }
+
+    SwapXorInitializeKeyStream();
+
+    SwapTransformRoutine = SwapXorTransformGeneric;
+
+#if defined(_M_AMD64)
+
+    SwapTransformRoutine = SwapXorTransformSse2;
+
+#if defined(PF_AVX2_INSTRUCTIONS_AVAILABLE)
+
+    if (ExIsProcessorFeaturePresent( PF_AVX2_INSTRUCTIONS_AVAILABLE )) {
+
+        SwapTransformRoutine = SwapXorTransformAvx2;
     }
+
+#endif
+#endif
+
+#if defined(_M_ARM64)
+
+    SwapTransformRoutine = SwapXorTransformNeon;
+
+#endif
+
+    LOG_PRINT( LOGFL_TRANSFORM,
+               ("SwapBuffers!SwapSelectTransform:            XOR transform, routine=%p\n",
+                SwapTransformRoutine) );
 }
 
+
+VOID
+SwapTransformData (
+    _Inout_updates_bytes_(Length) PVOID Buffer,
+    _In_ ULONG Length,
+    _In_ LONGLONG FileOffset,
+    _In_ BOOLEAN ToDisk
+    )
+/*++
+
+Routine Description:
+
+    This is where a filter built on this sample transforms (for example
+    encrypts) the data written to disk, and reverses the transform on the
+    data read from it.  It calls the routine SwapSelectTransform picked for
+    the configured transform, if any.  The sample's XOR transform is its
+    own inverse, so it ignores ToDisk.
+
+    Only noncached I/O is transformed, cached I/O is satisfied from the
+    cache which holds the data as it was before the transform.  The
+    transform must preserve the length and depend only on the file offset
+    of the data, since in SWAP_MODE_IN_PLACE it is applied to the pages a
+    read completes into.  It may be called at DPC level.
+
+Arguments:
+
+    Buffer - The data to transform.
+
+    Length - The number of bytes to transform.
+
+    FileOffset - The file offset of the first byte of Buffer.
+
+    ToDisk - TRUE if the data is being written, FALSE if it was read.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    UNREFERENCED_PARAMETER( ToDisk );
+
+    if (SwapTransformRoutine != NULL) {
+
+        SwapTransformRoutine( Buffer, Length, FileOffset );
+    }
+}
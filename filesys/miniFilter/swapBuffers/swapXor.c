@@ -0,0 +1,287 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All Rights Reserved
+
+Module Name:
+
+    swapXor.c
+
+Abstract:
+
+    This is the sample XOR transform of the swapBuffers filter, in a
+    version for each processor feature level.  SwapSelectTransform in
+    swapBuffers.c picks one at load time.  The file is also built into the
+    user mode benchmark in the bench directory, so it must not depend on
+    anything in swapBuffers.c.
+
+Environment:
+
+    Kernel & user mode
+
+--*/
+
+#if defined(_KERNEL_MODE)
+#include <fltKernel.h>
+#else
+#include <windows.h>
+#endif
+
+#if defined(_M_AMD64)
+#include <immintrin.h>
+#endif
+
+#if defined(_M_ARM64)
+#include <arm64_neon.h>
+#endif
+
+#include "swapXor.h"
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(INIT, SwapXorInitializeKeyStream)
+#endif
+
+const UCHAR SwapXorKey[SWAP_XOR_KEY_SIZE] = "SwapBuffers sample transform ke";
+
+UCHAR SwapXorKeyStream[2 * SWAP_XOR_KEY_SIZE];
+
+
+VOID
+SwapXorInitializeKeyStream (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    This routine fills in SwapXorKeyStream.  It must be called before any
+    of the transform routines.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    RtlCopyMemory( SwapXorKeyStream, SwapXorKey, SWAP_XOR_KEY_SIZE );
+    RtlCopyMemory( SwapXorKeyStream + SWAP_XOR_KEY_SIZE, SwapXorKey, SWAP_XOR_KEY_SIZE );
+}
+
+
+#if defined(_M_AMD64)
+
+VOID
+SwapXorTransformSse2 (
+    _Inout_updates_bytes_(Length) PUCHAR Buffer,
+    _In_ ULONG Length,
+    _In_ LONGLONG FileOffset
+    )
+/*++
+
+Routine Description:
+
+    SSE2 version of SwapXorTransformGeneric.  SSE2 is always present on
+    x64 and the kernel saves the XMM registers it uses, so no state has to
+    be saved here.
+
+Arguments:
+
+    Buffer - The data to transform.
+
+    Length - The number of bytes to transform.
+
+    FileOffset - The file offset of the first byte of Buffer.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    const UCHAR *key = &SwapXorKeyStream[FileOffset & (SWAP_XOR_KEY_SIZE - 1)];
+    __m128i key0 = _mm_loadu_si128( (const __m128i *) key );
+    __m128i key1 = _mm_loadu_si128( (const __m128i *) (key + 16) );
+    ULONG i;
+
+    for (i = 0; i + SWAP_XOR_KEY_SIZE <= Length; i += SWAP_XOR_KEY_SIZE) {
+
+        _mm_storeu_si128( (__m128i *) (Buffer + i),
+                          _mm_xor_si128( _mm_loadu_si128( (const __m128i *) (Buffer + i) ), key0 ) );
+
+        _mm_storeu_si128( (__m128i *) (Buffer + i + 16),
+                          _mm_xor_si128( _mm_loadu_si128( (const __m128i *) (Buffer + i + 16) ), key1 ) );
+    }
+
+    SwapXorTransformGeneric( Buffer + i,
+                             Length - i,
+                             FileOffset + i );
+}
+
+
+VOID
+SwapXorTransformAvx2 (
+    _Inout_updates_bytes_(Length) PUCHAR Buffer,
+    _In_ ULONG Length,
+    _In_ LONGLONG FileOffset
+    )
+/*++
+
+Routine Description:
+
+    AVX2 version of SwapXorTransformGeneric.  The YMM registers have to be
+    saved around their use in kernel mode, which is only worth it for
+    longer buffers.
+
+Arguments:
+
+    Buffer - The data to transform.
+
+    Length - The number of bytes to transform.
+
+    FileOffset - The file offset of the first byte of Buffer.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    const UCHAR *key = &SwapXorKeyStream[FileOffset & (SWAP_XOR_KEY_SIZE - 1)];
+#if defined(_KERNEL_MODE)
+    XSTATE_SAVE saveState;
+#endif
+    __m256i key0;
+    ULONG i;
+
+#if defined(_KERNEL_MODE)
+
+    if ((Length < SWAP_AVX2_MIN_LENGTH) ||
+        !NT_SUCCESS( KeSaveExtendedProcessorState( XSTATE_MASK_AVX, &saveState ) )) {
+
+        SwapXorTransformSse2( Buffer, Length, FileOffset );
+        return;
+    }
+
+#else
+
+    //
+    //  User mode threads always have their AVX state saved, so the
+    //  benchmark times the loop alone.  Short buffers still go to SSE2 so
+    //  that it sees the same split as the filter.
+    //
+
+    if (Length < SWAP_AVX2_MIN_LENGTH) {
+
+        SwapXorTransformSse2( Buffer, Length, FileOffset );
+        return;
+    }
+
+#endif
+
+    key0 = _mm256_loadu_si256( (const __m256i *) key );
+
+    for (i = 0; i + SWAP_XOR_KEY_SIZE <= Length; i += SWAP_XOR_KEY_SIZE) {
+
+        _mm256_storeu_si256( (__m256i *) (Buffer + i),
+                             _mm256_xor_si256( _mm256_loadu_si256( (const __m256i *) (Buffer + i) ), key0 ) );
+    }
+
+#if defined(_KERNEL_MODE)
+
+    KeRestoreExtendedProcessorState( &saveState );
+
+#endif
+
+    SwapXorTransformGeneric( Buffer + i,
+                             Length - i,
+                             FileOffset + i );
+}
+
+#endif
+
+
+#if defined(_M_ARM64)
+
+VOID
+SwapXorTransformNeon (
+    _Inout_updates_bytes_(Length) PUCHAR Buffer,
+    _In_ ULONG Length,
+    _In_ LONGLONG FileOffset
+    )
+/*++
+
+Routine Description:
+
+    NEON version of SwapXorTransformGeneric.  NEON is always present on
+    ARM64 and the kernel saves the registers it uses, so no state has to
+    be saved here.
+
+Arguments:
+
+    Buffer - The data to transform.
+
+    Length - The number of bytes to transform.
+
+    FileOffset - The file offset of the first byte of Buffer.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    const UCHAR *key = &SwapXorKeyStream[FileOffset & (SWAP_XOR_KEY_SIZE - 1)];
+    uint8x16_t key0 = vld1q_u8( key );
+    uint8x16_t key1 = vld1q_u8( key + 16 );
+    ULONG i;
+
+    for (i = 0; i + SWAP_XOR_KEY_SIZE <= Length; i += SWAP_XOR_KEY_SIZE) {
+
+        vst1q_u8( Buffer + i, veorq_u8( vld1q_u8( Buffer + i ), key0 ) );
+        vst1q_u8( Buffer + i + 16, veorq_u8( vld1q_u8( Buffer + i + 16 ), key1 ) );
+    }
+
+    SwapXorTransformGeneric( Buffer + i,
+                             Length - i,
+                             FileOffset + i );
+}
+
+#endif
+
+
+VOID
+SwapXorTransformGeneric (
+    _Inout_updates_bytes_(Length) PUCHAR Buffer,
+    _In_ ULONG Length,
+    _In_ LONGLONG FileOffset
+    )
+/*++
+
+Routine Description:
+
+    This routine XORs the data with the key stream of SWAP_TRANSFORM_XOR.
+
+Arguments:
+
+    Buffer - The data to transform.
+
+    Length - The number of bytes to transform.
+
+    FileOffset - The file offset of the first byte of Buffer.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    ULONG i;
+
+    for (i = 0; i < Length; i++) {
+
+        Buffer[i] ^= SwapXorKeyStream[(FileOffset + i) & (SWAP_XOR_KEY_SIZE - 1)];
+    }
+}
@@ -0,0 +1,89 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All Rights Reserved
+
+Module Name:
+
+    swapXor.h
+
+Abstract:
+
+    Header file which declares the processor specific versions of the
+    sample XOR transform.  They are shared by the filter and by the user
+    mode benchmark in the bench directory, which times them against each
+    other.
+
+Environment:
+
+    Kernel & user mode
+
+--*/
+
+#ifndef __SWAPXOR_H__
+#define __SWAPXOR_H__
+
+typedef VOID
+(*PSWAP_TRANSFORM_ROUTINE) (
+    _Inout_updates_bytes_(Length) PUCHAR Buffer,
+    _In_ ULONG Length,
+    _In_ LONGLONG FileOffset
+    );
+
+#define SWAP_XOR_KEY_SIZE           32              // a power of two
+
+//
+//  Buffers shorter than this are not worth saving the AVX state for.
+//
+
+#define SWAP_AVX2_MIN_LENGTH        1024
+
+//
+//  The key twice over, so that SWAP_XOR_KEY_SIZE bytes of key stream can be
+//  loaded at once for any file offset.  Filled in by
+//  SwapXorInitializeKeyStream.
+//
+
+extern UCHAR SwapXorKeyStream[2 * SWAP_XOR_KEY_SIZE];
+
+VOID
+SwapXorInitializeKeyStream (
+    VOID
+    );
+
+VOID
+SwapXorTransformGeneric (
+    _Inout_updates_bytes_(Length) PUCHAR Buffer,
+    _In_ ULONG Length,
+    _In_ LONGLONG FileOffset
+    );
+
+#if defined(_M_AMD64)
+
+VOID
+SwapXorTransformSse2 (
+    _Inout_updates_bytes_(Length) PUCHAR Buffer,
+    _In_ ULONG Length,
+    _In_ LONGLONG FileOffset
+    );
+
+VOID
+SwapXorTransformAvx2 (
+    _Inout_updates_bytes_(Length) PUCHAR Buffer,
+    _In_ ULONG Length,
+    _In_ LONGLONG FileOffset
+    );
+
+#endif
+
+#if defined(_M_ARM64)
+
+VOID
+SwapXorTransformNeon (
+    _Inout_updates_bytes_(Length) PUCHAR Buffer,
+    _In_ ULONG Length,
+    _In_ LONGLONG FileOffset
+    );
+
+#endif
+
+#endif /* __SWAPXOR_H__ */
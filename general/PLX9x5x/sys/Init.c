@@ -131,24 +131,27 @@ Return Value:
     // concurrent reads and writes) two Dispatch Queues are created:
     // one for the Write (ToDevice) requests and another for the Read
     // (FromDevice) requests.  While eache Dispatch Queue will operate
-    // independently for each other, the requests within a given Dispatch
-    // Queue will be serialized. This is hardware can only process one request
-    // per DMA Channel at a time.
+    // independently for each other, the hardware can only run one DTE chain
+    // per DMA Channel at a time. Each channel therefore has a ring of
+    // PLX_DMA_RING_SLOTS transactions: the chains of the requests behind
+    // the running one are built ahead of time and started from the DPC
+    // as soon as the channel goes idle.
     //
 
 
     //
-    // Setup a queue to handle only IRP_MJ_WRITE requests in Sequential
-    // dispatch mode. This mode ensures there is only one write request
-    // outstanding in the driver at any time. Framework will present the next
-    // request only if the current request is completed.
+    // Setup a queue to handle only IRP_MJ_WRITE requests in Parallel
+    // dispatch mode, limited to one request per write ring slot. Framework
+    // will present the next request only once a slot has been retired.
     // Since we have configured the queue to dispatch all the specific requests
     // we care about, we don't need a default queue.  A default queue is
     // used to receive requests that are not preconfigured to goto
     // a specific queue.
     //
     WDF_IO_QUEUE_CONFIG_INIT ( &queueConfig,
-                              WdfIoQueueDispatchSequential);
+                              WdfIoQueueDispatchParallel);
+
+    queueConfig.Settings.Parallel.NumberOfPresentedRequests = PLX_DMA_RING_SLOTS;
 
     queueConfig.EvtIoWrite = PLxEvtIoWrite;
 
@@ -197,10 +200,13 @@ Return Value:
 
 
     //
-    // Create a new IO Queue for IRP_MJ_READ requests in sequential mode.
+    // Create a new IO Queue for IRP_MJ_READ requests in parallel mode,
+    // again limited to the number of read ring slots.
     //
     WDF_IO_QUEUE_CONFIG_INIT( &queueConfig,
-                              WdfIoQueueDispatchSequential);
+                              WdfIoQueueDispatchParallel);
+
+    queueConfig.Settings.Parallel.NumberOfPresentedRequests = PLX_DMA_RING_SLOTS;
 
     queueConfig.EvtIoRead = PLxEvtIoRead;
 
@@ -263,6 +269,12 @@ Return Value:
         return status;
     }
 
+    status = PLxStreamInitialize( DevExt );
+
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
     return status;
 }
 
@@ -463,6 +475,7 @@ Return Value:
 {
     NTSTATUS    status;
     WDF_OBJECT_ATTRIBUTES attributes;
+    ULONG       i;
 
     PAGED_CODE();
 
@@ -507,8 +520,11 @@ Return Value:
     //       be used. This would have faster access, but requires
     //       flushing before starting the DMA in PLxStartWriteDma.
     //
+    // Each write ring slot gets WriteTransferElements DTEs of its own.
+    //
     DevExt->WriteCommonBufferSize =
-        sizeof(DMA_TRANSFER_ELEMENT) * DevExt->WriteTransferElements;
+        sizeof(DMA_TRANSFER_ELEMENT) * DevExt->WriteTransferElements *
+        PLX_DMA_RING_SLOTS;
 
     _Analysis_assume_(DevExt->WriteCommonBufferSize > 0);
     status = WdfCommonBufferCreate( DevExt->DmaEnabler,
@@ -546,8 +562,11 @@ Return Value:
     //       be used. This would have faster access, but requires
     //       flushing before starting the DMA in PLxStartReadDma.
     //
+    // Each read ring slot gets ReadTransferElements DTEs of its own.
+    //
     DevExt->ReadCommonBufferSize =
-        sizeof(DMA_TRANSFER_ELEMENT) * DevExt->ReadTransferElements;
+        sizeof(DMA_TRANSFER_ELEMENT) * DevExt->ReadTransferElements *
+        PLX_DMA_RING_SLOTS;
 
     _Analysis_assume_(DevExt->ReadCommonBufferSize > 0);
     status = WdfCommonBufferCreate( DevExt->DmaEnabler,
@@ -577,39 +596,65 @@ Return Value:
                 WdfCommonBufferGetLength(DevExt->ReadCommonBuffer) );
 
     //
-    // Since we are using sequential queue and processing one request
-    // at a time, we will create transaction objects upfront and reuse
-    // them to do DMA transfer. Transactions objects are parented to
+    // Since every request is processed in one of a fixed number of ring
+    // slots, we will create a transaction object upfront for each slot and
+    // reuse them to do DMA transfer. Transactions objects are parented to
     // DMA enabler object by default. They will be deleted along with
     // along with the DMA enabler object. So need to delete them
     // explicitly.
     //
-    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, TRANSACTION_CONTEXT);
-    
-    status = WdfDmaTransactionCreate( DevExt->DmaEnabler,
-                                      &attributes,
-                                      &DevExt->ReadDmaTransaction);
+    for (i = 0; i < PLX_DMA_RING_SLOTS; i++) {
 
-    if(!NT_SUCCESS(status)) {
-        TraceEvents(TRACE_LEVEL_ERROR, DBG_WRITE,
-                    "WdfDmaTransactionCreate(read) failed: %!STATUS!", status);
-        return status;
-    }
+        PDMA_RING_SLOT slot;
 
-    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, TRANSACTION_CONTEXT);
-    //
-    // Create a new DmaTransaction.
-    //
-    status = WdfDmaTransactionCreate( DevExt->DmaEnabler,
-                                      &attributes,
-                                      &DevExt->WriteDmaTransaction );
+        slot = &DevExt->ReadRing.Slots[i];
 
-    if(!NT_SUCCESS(status)) {
-        TraceEvents(TRACE_LEVEL_ERROR, DBG_WRITE,
-                    "WdfDmaTransactionCreate(write) failed: %!STATUS!", status);
-        return status;
+        WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, TRANSACTION_CONTEXT);
+
+        status = WdfDmaTransactionCreate( DevExt->DmaEnabler,
+                                          &attributes,
+                                          &slot->DmaTransaction);
+
+        if(!NT_SUCCESS(status)) {
+            TraceEvents(TRACE_LEVEL_ERROR, DBG_WRITE,
+                        "WdfDmaTransactionCreate(read) failed: %!STATUS!", status);
+            return status;
+        }
+
+        PLxGetTransactionContext(slot->DmaTransaction)->Slot = slot;
+
+        slot->DteVA = (PDMA_TRANSFER_ELEMENT) DevExt->ReadCommonBufferBase +
+                      (i * DevExt->ReadTransferElements);
+        slot->DteLA.QuadPart = DevExt->ReadCommonBufferBaseLA.QuadPart +
+                      (i * DevExt->ReadTransferElements * sizeof(DMA_TRANSFER_ELEMENT));
+
+        slot = &DevExt->WriteRing.Slots[i];
+
+        WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, TRANSACTION_CONTEXT);
+        //
+        // Create a new DmaTransaction.
+        //
+        status = WdfDmaTransactionCreate( DevExt->DmaEnabler,
+                                          &attributes,
+                                          &slot->DmaTransaction );
+
+        if(!NT_SUCCESS(status)) {
+            TraceEvents(TRACE_LEVEL_ERROR, DBG_WRITE,
+                        "WdfDmaTransactionCreate(write) failed: %!STATUS!", status);
+            return status;
+        }
+
+        PLxGetTransactionContext(slot->DmaTransaction)->Slot = slot;
+
+        slot->DteVA = (PDMA_TRANSFER_ELEMENT) DevExt->WriteCommonBufferBase +
+                      (i * DevExt->WriteTransferElements);
+        slot->DteLA.QuadPart = DevExt->WriteCommonBufferBaseLA.QuadPart +
+                      (i * DevExt->WriteTransferElements * sizeof(DMA_TRANSFER_ELEMENT));
     }
 
+    PLxDmaRingReset( &DevExt->ReadRing );
+    PLxDmaRingReset( &DevExt->WriteRing );
+
     return status;
 }
 
@@ -645,6 +690,11 @@ Return Value:
     //
     DevExt->Dma0Csr.uchar = 0;
 
+    //
+    // Nothing can be in flight on the write channel when we get here.
+    //
+    PLxDmaRingReset( &DevExt->WriteRing );
+
 
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_PNP, "<-- PLxInitWrite");
 
@@ -681,6 +731,11 @@ Return Value:
     //
     DevExt->Dma1Csr.uchar = 0;
 
+    //
+    // Nothing can be in flight on the read channel when we get here.
+    //
+    PLxDmaRingReset( &DevExt->ReadRing );
+
 
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_PNP, "<-- PLxInitRead");
 
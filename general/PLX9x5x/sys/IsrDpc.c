@@ -153,9 +153,29 @@ Return Value:
     }
 
     //
-    // Is DMA channel 1 (Read-side) Active?
+    // Is DMA channel 1 running the stream chain? Then every interrupt is
+    // a filled chunk and there is no request to complete.
     //
-    if (intCsr.bits.DmaChan1IntActive) {
+    if (intCsr.bits.DmaChan1IntActive && devExt->StreamRunning) {
+
+        union {
+            DMA_CSR  bits;
+            UCHAR    uchar;
+        } dmaCSR;
+
+        PLxStreamChunkDone(devExt);
+
+        dmaCSR.uchar =
+            READ_REGISTER_UCHAR( (PUCHAR) &devExt->Regs->Dma1_Csr );
+
+        dmaCSR.bits.Clear = TRUE;
+
+        WRITE_REGISTER_UCHAR( (PUCHAR) &devExt->Regs->Dma1_Csr,
+                              dmaCSR.uchar );
+
+        isRecognized = TRUE;
+
+    } else if (intCsr.bits.DmaChan1IntActive) {
 
         TraceEvents(TRACE_LEVEL_INFORMATION, DBG_INTERRUPT,
                     " Interrupt for DMA Channel 1 (read)");
@@ -220,6 +240,8 @@ Return Value:
     PDEVICE_EXTENSION   devExt;
     BOOLEAN             writeInterrupt = FALSE;
     BOOLEAN             readInterrupt  = FALSE;
+    PDMA_RING_SLOT      writeSlot = NULL;
+    PDMA_RING_SLOT      readSlot  = NULL;
 
     UNREFERENCED_PARAMETER(Device);
 
@@ -247,6 +269,14 @@ Return Value:
         devExt->IntCsr.bits.DmaChan0IntActive = FALSE;
         devExt->Dma0Csr.uchar = 0;
 
+        //
+        // The chain that finished belongs to the slot at the head of
+        // the write ring.
+        //
+        writeSlot = &devExt->WriteRing.Slots[devExt->WriteRing.Head];
+        ASSERT(writeSlot->State == DmaSlotRunning);
+        writeSlot->State = DmaSlotReserved;
+
         writeInterrupt = TRUE;
     }
 
@@ -262,7 +292,15 @@ Return Value:
         //  our copies...
         //
         devExt->IntCsr.bits.DmaChan1IntActive = FALSE;
-        devExt->Dma0Csr.uchar = 0;
+        devExt->Dma1Csr.uchar = 0;
+
+        //
+        // The chain that finished belongs to the slot at the head of
+        // the read ring.
+        //
+        readSlot = &devExt->ReadRing.Slots[devExt->ReadRing.Head];
+        ASSERT(readSlot->State == DmaSlotRunning);
+        readSlot->State = DmaSlotReserved;
 
         readInterrupt = TRUE;
     }
@@ -282,7 +320,7 @@ Return Value:
         //
         // Get the current Write DmaTransaction.
         //
-        dmaTransaction = devExt->WriteDmaTransaction;
+        dmaTransaction = writeSlot->DmaTransaction;
 
         //
         // Indicate this DMA operation has completed:
@@ -293,6 +331,12 @@ Return Value:
                                                          &status );
 
         if (transactionComplete) {
+            //
+            // Retire the slot first, so that the next write is already
+            // on the channel while this one is being completed.
+            //
+            PLxDmaRingRetire( devExt, &devExt->WriteRing, writeSlot );
+
             //
             // Complete this DmaTransaction.
             //
@@ -316,7 +360,7 @@ Return Value:
         //
         // Get the current Read DmaTransaction.
         //
-        dmaTransaction = devExt->ReadDmaTransaction;
+        dmaTransaction = readSlot->DmaTransaction;
 
         //
         // Only on Read-side --
@@ -325,7 +369,7 @@ Return Value:
         //
         length = WdfDmaTransactionGetCurrentDmaTransferLength( dmaTransaction );
 
-        dteVA = (PDMA_TRANSFER_ELEMENT) devExt->ReadCommonBufferBase;
+        dteVA = readSlot->DteVA;
 
         while(dteVA->DescPtr.LastElement == FALSE) {
             length -= dteVA->TransferSize;
@@ -344,6 +388,12 @@ Return Value:
                                                      &status );
 
         if (transactionComplete) {
+            //
+            // Retire the slot first, so that the next read is already
+            // on the channel while this one is being completed.
+            //
+            PLxDmaRingRetire( devExt, &devExt->ReadRing, readSlot );
+
             //
             // Complete this DmaTransaction.
             //
@@ -360,6 +410,220 @@ Return Value:
     return;
 }
 
+VOID
+PLxDmaRingReset(
+    IN PDMA_RING Ring
+    )
+/*++
+
+Routine Description:
+
+    Mark every slot of the ring free. Only called while nothing can be in
+    flight on the channel.
+
+Arguments:
+
+    Ring       Read or write ring
+
+Return Value:
+
+--*/
+{
+    ULONG i;
+
+    for (i = 0; i < PLX_DMA_RING_SLOTS; i++) {
+        Ring->Slots[i].State = DmaSlotFree;
+    }
+
+    Ring->Head  = 0;
+    Ring->Tail  = 0;
+    Ring->Count = 0;
+}
+
+PDMA_RING_SLOT
+PLxDmaRingReserve(
+    IN PDEVICE_EXTENSION DevExt,
+    IN PDMA_RING         Ring
+    )
+/*++
+
+Routine Description:
+
+    Hand out the slot at the tail of the ring to a newly dispatched request.
+
+Arguments:
+
+    DevExt     Pointer to our DEVICE_EXTENSION
+    Ring       Read or write ring
+
+Return Value:
+
+    The reserved slot. The queue presents at most PLX_DMA_RING_SLOTS
+    requests, so there is always one free.
+
+    NULL for the read ring while a stream owns DMA channel 1.
+
+--*/
+{
+    PDMA_RING_SLOT slot;
+
+    WdfInterruptAcquireLock( DevExt->Interrupt );
+
+    if (Ring == &DevExt->ReadRing && DevExt->StreamClaimed) {
+        WdfInterruptReleaseLock( DevExt->Interrupt );
+        return NULL;
+    }
+
+    ASSERT(Ring->Count < PLX_DMA_RING_SLOTS);
+
+    slot = &Ring->Slots[Ring->Tail];
+
+    ASSERT(slot->State == DmaSlotFree);
+
+    slot->State = DmaSlotReserved;
+
+    Ring->Tail = (Ring->Tail + 1) % PLX_DMA_RING_SLOTS;
+    Ring->Count++;
+
+    WdfInterruptReleaseLock( DevExt->Interrupt );
+
+    return slot;
+}
+
+VOID
+PLxDmaRingStartNext(
+    IN PDEVICE_EXTENSION DevExt,
+    IN PDMA_RING         Ring
+    )
+/*++
+
+Routine Description:
+
+    Discard failed slots at the head of the ring, then start the chain of
+    the head slot if it is ready and the channel is idle.
+
+    Called with the interrupt spinlock held.
+
+Arguments:
+
+    DevExt     Pointer to our DEVICE_EXTENSION
+    Ring       Read or write ring
+
+Return Value:
+
+--*/
+{
+    PDMA_RING_SLOT slot;
+
+    while (Ring->Count > 0) {
+
+        slot = &Ring->Slots[Ring->Head];
+
+        if (slot->State != DmaSlotVoid) {
+            break;
+        }
+
+        slot->State = DmaSlotFree;
+        Ring->Head = (Ring->Head + 1) % PLX_DMA_RING_SLOTS;
+        Ring->Count--;
+    }
+
+    if (Ring->Count == 0) {
+        return;
+    }
+
+    slot = &Ring->Slots[Ring->Head];
+
+    if (slot->State != DmaSlotReady) {
+        //
+        // Either the channel is running this slot already or its chain
+        // has not been built yet.
+        //
+        return;
+    }
+
+    slot->State = DmaSlotRunning;
+
+    if (Ring == &DevExt->ReadRing) {
+        PLxStartReadDma( DevExt, slot );
+    } else {
+        PLxStartWriteDma( DevExt, slot );
+    }
+}
+
+VOID
+PLxDmaRingSlotReady(
+    IN PDEVICE_EXTENSION DevExt,
+    IN PDMA_RING         Ring,
+    IN PDMA_RING_SLOT    Slot,
+    IN BOOLEAN           Ready
+    )
+/*++
+
+Routine Description:
+
+    Called once the DTE chain of a reserved slot has been built (Ready) or
+    the transaction failed before it reached the channel (!Ready).
+
+Arguments:
+
+    DevExt     Pointer to our DEVICE_EXTENSION
+    Ring       Ring owning the slot
+    Slot       Slot whose chain is ready
+    Ready      FALSE if the slot is to be skipped
+
+Return Value:
+
+--*/
+{
+    WdfInterruptAcquireLock( DevExt->Interrupt );
+
+    ASSERT(Slot->State == DmaSlotReserved);
+
+    Slot->State = Ready ? DmaSlotReady : DmaSlotVoid;
+
+    PLxDmaRingStartNext( DevExt, Ring );
+
+    WdfInterruptReleaseLock( DevExt->Interrupt );
+}
+
+VOID
+PLxDmaRingRetire(
+    IN PDEVICE_EXTENSION DevExt,
+    IN PDMA_RING         Ring,
+    IN PDMA_RING_SLOT    Slot
+    )
+/*++
+
+Routine Description:
+
+    The transaction of the head slot is complete. Free the slot and put the
+    next chain on the channel.
+
+Arguments:
+
+    DevExt     Pointer to our DEVICE_EXTENSION
+    Ring       Ring owning the slot
+    Slot       Head slot of the ring
+
+Return Value:
+
+--*/
+{
+    WdfInterruptAcquireLock( DevExt->Interrupt );
+
+    ASSERT(Slot == &Ring->Slots[Ring->Head]);
+    ASSERT(Slot->State == DmaSlotReserved);
+
+    Slot->State = DmaSlotFree;
+    Ring->Head = (Ring->Head + 1) % PLX_DMA_RING_SLOTS;
+    Ring->Count--;
+
+    PLxDmaRingStartNext( DevExt, Ring );
+
+    WdfInterruptReleaseLock( DevExt->Interrupt );
+}
+
 NTSTATUS
 PLxEvtInterruptEnable(
     IN WDFINTERRUPT Interrupt,
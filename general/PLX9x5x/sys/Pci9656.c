@@ -148,6 +148,7 @@ Return Value:
 {
     NTSTATUS                   status = STATUS_SUCCESS;
     WDF_PNPPOWER_EVENT_CALLBACKS pnpPowerCallbacks;
+    WDF_FILEOBJECT_CONFIG       fileConfig;
     WDF_OBJECT_ATTRIBUTES       attributes;
     WDFDEVICE                   device;
     PDEVICE_EXTENSION           devExt = NULL;
@@ -185,6 +186,22 @@ Return Value:
     //
     WdfDeviceInitSetPnpPowerEventCallbacks(DeviceInit, &pnpPowerCallbacks);
 
+    //
+    // The stream IOCTLs have to be handled at PASSIVE_LEVEL, and a stream
+    // still running when its handle goes away has to be stopped.
+    //
+    WdfDeviceInitSetIoInCallerContextCallback(DeviceInit,
+                                              PLxEvtIoInCallerContext);
+
+    WDF_FILEOBJECT_CONFIG_INIT(&fileConfig,
+                               WDF_NO_EVENT_CALLBACK,
+                               WDF_NO_EVENT_CALLBACK,
+                               PLxEvtFileCleanup);
+
+    WdfDeviceInitSetFileObjectConfig(DeviceInit,
+                                     &fileConfig,
+                                     WDF_NO_OBJECT_ATTRIBUTES);
+
     //
     // Initialize Fdo Attributes.
     //
@@ -451,6 +468,14 @@ Return Value:
 
     }
 
+    //
+    // Put a stream that was running before the power transition back on
+    // the channel. The interrupt is not connected yet, so no lock needed.
+    //
+    if (NT_SUCCESS(status) && devExt->StreamClaimed && devExt->StreamDteCount != 0) {
+        PLxStartStreamDma( devExt );
+    }
+
     return status;
 }
 
@@ -492,6 +517,14 @@ Return Value:
 
     devExt = PLxGetDeviceContext(Device);
 
+    //
+    // Take the stream off DMA channel 1; it keeps its buffer and chain,
+    // and D0Entry starts it again.
+    //
+    if (devExt->StreamRunning) {
+        PLxStreamAbortDma( devExt, FALSE );
+    }
+
     switch (TargetState) {
     case WdfPowerDeviceD1:
     case WdfPowerDeviceD2:
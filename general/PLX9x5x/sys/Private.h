@@ -23,6 +23,47 @@ Environment:
 #if !defined(_PCI9656_H_)
 #define _PCI9659_H_
 
+//
+// Number of transactions each DMA channel can have in flight. Every slot
+// owns a DMA_TRANSFER_ELEMENT chain in the channel's common buffer, so a
+// transaction can be mapped and its chain built while the channel is still
+// busy with an earlier one.
+//
+#define PLX_DMA_RING_SLOTS      4
+
+typedef enum _DMA_SLOT_STATE {
+
+    DmaSlotFree = 0,        // not in use
+    DmaSlotReserved,        // transaction dispatched, waiting for EvtProgramDma
+    DmaSlotReady,           // DTE chain built, waiting for the channel
+    DmaSlotRunning,         // chain is on the channel
+    DmaSlotVoid             // failed before reaching the channel
+
+} DMA_SLOT_STATE;
+
+typedef struct _DMA_RING_SLOT {
+
+    DMA_SLOT_STATE          State;
+    WDFDMATRANSACTION       DmaTransaction;
+    PDMA_TRANSFER_ELEMENT   DteVA;            // this slot's DTE chain
+    PHYSICAL_ADDRESS        DteLA;            // Logical Address
+
+} DMA_RING_SLOT, *PDMA_RING_SLOT;
+
+//
+// Slots are handed out at Tail in dispatch order and retired at Head, so
+// the requests of a channel are always completed in the order they were
+// started. The ring is protected by the interrupt spinlock.
+//
+typedef struct _DMA_RING {
+
+    DMA_RING_SLOT           Slots[PLX_DMA_RING_SLOTS];
+    ULONG                   Head;
+    ULONG                   Tail;
+    ULONG                   Count;            // slots not DmaSlotFree
+
+} DMA_RING, *PDMA_RING;
+
 //
 // The device extension for the device object
 //
@@ -71,7 +112,7 @@ typedef struct _DEVICE_EXTENSION {
     // Write
     WDFQUEUE                WriteQueue;
 
-    WDFDMATRANSACTION       WriteDmaTransaction;
+    DMA_RING                WriteRing;
 
     ULONG                   WriteTransferElements;
     WDFCOMMONBUFFER         WriteCommonBuffer;
@@ -86,12 +127,30 @@ typedef struct _DEVICE_EXTENSION {
     _Field_size_(ReadCommonBufferSize) PUCHAR ReadCommonBufferBase;
     PHYSICAL_ADDRESS        ReadCommonBufferBaseLA;   // Logical Address
 
-    WDFDMATRANSACTION       ReadDmaTransaction;
+    DMA_RING                ReadRing;
 
     WDFQUEUE                ReadQueue;
 
     ULONG                   HwErrCount;
 
+    // Stream (IOCTL_PLX_STREAM_START)
+    WDFQUEUE                StreamQueue;      // holds the start request
+    WDFDMAENABLER           StreamDmaEnabler;
+    WDFDMATRANSACTION       StreamDmaTransaction;
+    KEVENT                  StreamProgrammed; // PLxEvtProgramStreamDma has run
+    NTSTATUS                StreamProgramStatus;
+    BOOLEAN                 StreamClaimed;    // read channel belongs to the stream
+    BOOLEAN                 StreamRunning;    // chain is on the channel
+    ULONG                   StreamChunkSize;
+    ULONG                   StreamChunkCount;
+    PMDL                    StreamHeaderMdl;  // partial MDL for the header page
+    PPLX_STREAM_HEADER      StreamHeader;     // system address of the header
+    WDFCOMMONBUFFER         StreamDteBuffer;  // kept from one stream to the next
+    ULONG                   StreamDteCapacity;
+    ULONG                   StreamDteCount;   // nonzero once the chain is built
+    PDMA_TRANSFER_ELEMENT   StreamDteVA;      // circular DTE chain
+    PHYSICAL_ADDRESS        StreamDteLA;      // Logical Address
+
 }  DEVICE_EXTENSION, *PDEVICE_EXTENSION;
 
 //
@@ -100,20 +159,21 @@ typedef struct _DEVICE_EXTENSION {
 //
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(DEVICE_EXTENSION, PLxGetDeviceContext)
 
-#if !defined(ASSOC_WRITE_REQUEST_WITH_DMA_TRANSACTION)
 //
 // The context structure used with WdfDmaTransactionCreate
 //
 typedef struct TRANSACTION_CONTEXT {
 
+#if !defined(ASSOC_WRITE_REQUEST_WITH_DMA_TRANSACTION)
     WDFREQUEST     Request;
+#endif
+
+    PDMA_RING_SLOT Slot;        // ring slot owning this transaction
 
 } TRANSACTION_CONTEXT, * PTRANSACTION_CONTEXT;
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(TRANSACTION_CONTEXT, PLxGetTransactionContext)
 
-#endif
-
 //
 // Function prototypes
 //
@@ -131,6 +191,10 @@ EVT_WDF_DEVICE_RELEASE_HARDWARE PLxEvtDeviceReleaseHardware;
 EVT_WDF_IO_QUEUE_IO_READ PLxEvtIoRead;
 EVT_WDF_IO_QUEUE_IO_WRITE PLxEvtIoWrite;
 
+EVT_WDF_IO_IN_CALLER_CONTEXT PLxEvtIoInCallerContext;
+EVT_WDF_FILE_CLEANUP PLxEvtFileCleanup;
+EVT_WDF_IO_QUEUE_IO_CANCELED_ON_QUEUE PLxEvtStreamCanceledOnQueue;
+
 EVT_WDF_INTERRUPT_ISR PLxEvtInterruptIsr;
 EVT_WDF_INTERRUPT_DPC PLxEvtInterruptDpc;
 EVT_WDF_INTERRUPT_ENABLE PLxEvtInterruptEnable;
@@ -193,6 +257,7 @@ PLxShutdown(
     );
 
 EVT_WDF_PROGRAM_DMA PLxEvtProgramReadDma;
+EVT_WDF_PROGRAM_DMA PLxEvtProgramStreamDma;
 EVT_WDF_PROGRAM_DMA PLxEvtProgramWriteDma;
 
 VOID
@@ -205,6 +270,77 @@ PLxInitializeDMA(
     IN PDEVICE_EXTENSION DevExt
     );
 
+//
+// DMA ring support
+//
+VOID
+PLxDmaRingReset(
+    IN PDMA_RING Ring
+    );
+
+PDMA_RING_SLOT
+PLxDmaRingReserve(
+    IN PDEVICE_EXTENSION DevExt,
+    IN PDMA_RING         Ring
+    );
+
+VOID
+PLxDmaRingStartNext(
+    IN PDEVICE_EXTENSION DevExt,
+    IN PDMA_RING         Ring
+    );
+
+VOID
+PLxDmaRingRetire(
+    IN PDEVICE_EXTENSION DevExt,
+    IN PDMA_RING         Ring,
+    IN PDMA_RING_SLOT    Slot
+    );
+
+VOID
+PLxDmaRingSlotReady(
+    IN PDEVICE_EXTENSION DevExt,
+    IN PDMA_RING         Ring,
+    IN PDMA_RING_SLOT    Slot,
+    IN BOOLEAN           Ready
+    );
+
+VOID
+PLxStartReadDma(
+    IN PDEVICE_EXTENSION DevExt,
+    IN PDMA_RING_SLOT    Slot
+    );
+
+VOID
+PLxStartWriteDma(
+    IN PDEVICE_EXTENSION DevExt,
+    IN PDMA_RING_SLOT    Slot
+    );
+
+//
+// Stream support
+//
+NTSTATUS
+PLxStreamInitialize(
+    IN PDEVICE_EXTENSION DevExt
+    );
+
+VOID
+PLxStartStreamDma(
+    IN PDEVICE_EXTENSION DevExt
+    );
+
+VOID
+PLxStreamAbortDma(
+    IN PDEVICE_EXTENSION DevExt,
+    IN BOOLEAN           Synchronize
+    );
+
+VOID
+PLxStreamChunkDone(
+    IN PDEVICE_EXTENSION DevExt
+    );
+
 #pragma warning(disable:4127) // avoid conditional expression is constant error with W4
 
 #endif  // _PCI9656_H_
@@ -32,4 +32,49 @@ Environment:
 DEFINE_GUID (GUID_PLX_INTERFACE, 
    0x29d2a384, 0x2e47, 0x49b5, 0xae, 0xbf, 0x69, 0x62, 0xc2, 0x2b, 0xd7, 0xc2);
 
+//
+// Continuous acquisition into a buffer shared with the application.
+//
+// IOCTL_PLX_STREAM_START takes a PLX_STREAM_START as input and the stream
+// buffer as output: PLX_STREAM_BUFFER_SIZE(ChunkSize, ChunkCount) bytes,
+// page aligned. The driver locks the buffer, runs DMA channel 1 around it
+// and keeps the request pending for as long as the stream runs, so the
+// handle must be opened for overlapped I/O. IOCTL_PLX_STREAM_STOP completes
+// it; so do cancelling it and closing the handle. The buffer belongs to the
+// driver until the start request has completed. Reads fail with
+// STATUS_DEVICE_BUSY while a stream owns the channel.
+//
+// The buffer starts with a PLX_STREAM_HEADER and the chunks follow at
+// DataOffset. The driver bumps ProducerIndex each time a chunk has been
+// filled; chunk N is at DataOffset + (N % ChunkCount) * ChunkSize. The
+// application advances ConsumerIndex as it drains the chunks. A chunk that
+// gets overwritten before ConsumerIndex passes it is counted in Overruns.
+//
+#define IOCTL_PLX_STREAM_START  CTL_CODE(FILE_DEVICE_UNKNOWN, 0x800, METHOD_OUT_DIRECT, FILE_READ_ACCESS)
+#define IOCTL_PLX_STREAM_STOP   CTL_CODE(FILE_DEVICE_UNKNOWN, 0x801, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+#define PLX_STREAM_MAXIMUM_CHUNKS   1024
+#define PLX_STREAM_MAXIMUM_LENGTH   (16 * 1024 * 1024)
+
+typedef struct _PLX_STREAM_START {
+
+    ULONG           ChunkSize;          // bytes, multiple of 4
+    ULONG           ChunkCount;         // 2 - PLX_STREAM_MAXIMUM_CHUNKS
+
+} PLX_STREAM_START, *PPLX_STREAM_START;
+
+#define PLX_STREAM_HEADER_SIZE      4096    // the header has a page to itself
+
+#define PLX_STREAM_BUFFER_SIZE(ChunkSize, ChunkCount) \
+    (PLX_STREAM_HEADER_SIZE + (size_t) (ChunkSize) * (ChunkCount))
+
+typedef struct _PLX_STREAM_HEADER {
+
+    volatile LONG   ProducerIndex;      // written by the driver
+    volatile LONG   ConsumerIndex;      // written by the application
+    volatile ULONG  Overruns;           // written by the driver
+    ULONG           ChunkSize;
+    ULONG           ChunkCount;
+    ULONG           DataOffset;
 
+} PLX_STREAM_HEADER, *PPLX_STREAM_HEADER;
@@ -59,6 +59,7 @@ Return Value:
 {
     NTSTATUS                status = STATUS_UNSUCCESSFUL;
     PDEVICE_EXTENSION       devExt;
+    PDMA_RING_SLOT          slot = NULL;
 
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_READ,
                 "--> PLxEvtIoRead: Request %p", Request);
@@ -76,12 +77,26 @@ Return Value:
             status = STATUS_INVALID_BUFFER_SIZE;
             break;
         }
+
+        //
+        // Take the next read ring slot. The queue never presents more
+        // requests than there are slots.
+        //
+        slot = PLxDmaRingReserve( devExt, &devExt->ReadRing );
+
+        if (slot == NULL) {
+            //
+            // DMA channel 1 is streaming into an application buffer.
+            //
+            status = STATUS_DEVICE_BUSY;
+            break;
+        }
         
         //
         // Initialize this new DmaTransaction.
         //
         status = WdfDmaTransactionInitializeUsingRequest(
-                                              devExt->ReadDmaTransaction,
+                                              slot->DmaTransaction,
                                               Request,
                                               PLxEvtProgramReadDma,
                                               WdfDmaDirectionReadFromDevice );
@@ -106,7 +121,7 @@ Return Value:
             //TraceEvents(TRACE_LEVEL_INFORMATION, DBG_READ,
             //            "Setting a new MaxLen %d\n", length);
 
-            WdfDmaTransactionSetMaximumLength( devExt->ReadDmaTransaction, 
+            WdfDmaTransactionSetMaximumLength( slot->DmaTransaction, 
                                                length );
         }
 #endif
@@ -114,7 +129,7 @@ Return Value:
         //
         // Execute this DmaTransaction.
         //
-        status = WdfDmaTransactionExecute( devExt->ReadDmaTransaction, 
+        status = WdfDmaTransactionExecute( slot->DmaTransaction, 
                                            WDF_NO_CONTEXT);
 
         if(!NT_SUCCESS(status)) {
@@ -139,7 +154,14 @@ Return Value:
     // If there are errors, then clean up and complete the Request.
     //
     if (!NT_SUCCESS(status )) {
-        WdfDmaTransactionRelease(devExt->ReadDmaTransaction);
+        if (slot != NULL) {
+            WdfDmaTransactionRelease(slot->DmaTransaction);
+
+            //
+            // The slot never reached the channel; let the ring skip it.
+            //
+            PLxDmaRingSlotReady( devExt, &devExt->ReadRing, slot, FALSE );
+        }
         WdfRequestComplete(Request, status);
     }
 
@@ -180,6 +202,7 @@ Return Value:
 --*/
 {
     PDEVICE_EXTENSION        devExt;
+    PDMA_RING_SLOT           slot;
     size_t                   offset;
     PDMA_TRANSFER_ELEMENT    dteVA;
     ULONG_PTR                dteLA;
@@ -196,8 +219,11 @@ Return Value:
     // Initialize locals
     //
     devExt = PLxGetDeviceContext(Device);
+    slot = PLxGetTransactionContext(Transaction)->Slot;
     errors = FALSE;
 
+    ASSERT(slot->State == DmaSlotReserved);
+
     //
     // Get the number of bytes as the offset to the beginning of this
     // Dma operations transfer location in the buffer.
@@ -208,8 +234,8 @@ Return Value:
     // Setup the pointer to the next DMA_TRANSFER_ELEMENT
     // for both virtual and physical address references.
     //
-    dteVA = (PDMA_TRANSFER_ELEMENT) devExt->ReadCommonBufferBase;
-    dteLA = (devExt->ReadCommonBufferBaseLA.LowPart +
+    dteVA = slot->DteVA;
+    dteLA = (slot->DteLA.LowPart +
                         sizeof(DMA_TRANSFER_ELEMENT));
 
     //
@@ -284,11 +310,66 @@ Return Value:
     }
 
     //
-    // Start the DMA operation.
-    // Acquire this device's InterruptSpinLock.
+    // The chain is complete. Start it now if the channel is idle and this
+    // slot is next in line, otherwise the DPC starts it when its turn comes.
+    //
+    if (!errors) {
+        PLxDmaRingSlotReady( devExt, &devExt->ReadRing, slot, TRUE );
+    }
+
     //
-    WdfInterruptAcquireLock( devExt->Interrupt );
+    // NOTE: This shows how to process errors which occur in the
+    //       PFN_WDF_PROGRAM_DMA function in general.
+    //       Basically the DmaTransaction must be deleted and
+    //       the Request must be completed.
+    //
+    if (errors) {
+        NTSTATUS status;
+
+        //
+        // Must abort the transaction before deleting.
+        //
+        (VOID) WdfDmaTransactionDmaCompletedFinal(Transaction, 0, &status);
+        ASSERT(NT_SUCCESS(status));
+
+        PLxDmaRingSlotReady( devExt, &devExt->ReadRing, slot, FALSE );
+
+        PLxReadRequestComplete( Transaction, STATUS_INVALID_DEVICE_STATE );
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_READ,
+                    "<-- PLxEvtProgramReadDma: errors ****");
+        return FALSE;
+    }
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_READ,
+                "<-- PLxEvtProgramReadDma");
+
+    return TRUE;
+}
+
+VOID
+PLxStartReadDma(
+    IN PDEVICE_EXTENSION DevExt,
+    IN PDMA_RING_SLOT    Slot
+    )
+/*++
+
+Routine Description:
+
+    Put the DTE chain of this read ring slot on DMA channel 1 and start it.
+
+    Called with the interrupt spinlock held, either from
+    PLxEvtProgramReadDma when the channel is idle or from the DPC when the
+    previous chain is done.
+
+Arguments:
+
+    DevExt     Pointer to Device Extension
+    Slot       Read ring slot whose chain is to be started
+
+Return Value:
 
+--*/
+{
     //
     // DMA 1 Mode Register - (DMAMODE1)
     // Enable Scatter/Gather Mode, Interrupt On Done,
@@ -301,7 +382,7 @@ Return Value:
         } dmaMode;
 
         dmaMode.ulong =
-            READ_REGISTER_ULONG( (PULONG) &devExt->Regs->Dma1_Mode );
+            READ_REGISTER_ULONG( (PULONG) &DevExt->Regs->Dma1_Mode );
 
         dmaMode.bits.SgModeEnable   = TRUE;
         dmaMode.bits.DoneIntEnable  = TRUE;
@@ -309,7 +390,7 @@ Return Value:
 
         dmaMode.bits.ClearCountMode = TRUE;
 
-        WRITE_REGISTER_ULONG( (PULONG) &devExt->Regs->Dma1_Mode,
+        WRITE_REGISTER_ULONG( (PULONG) &DevExt->Regs->Dma1_Mode,
                               dmaMode.ulong );
     }
 
@@ -324,18 +405,18 @@ Return Value:
         } intCSR;
 
         intCSR.ulong =
-            READ_REGISTER_ULONG( (PULONG) &devExt->Regs->Int_Csr );
+            READ_REGISTER_ULONG( (PULONG) &DevExt->Regs->Int_Csr );
 
         intCSR.bits.PciIntEnable      = TRUE;
         intCSR.bits.DmaChan1IntEnable = TRUE;
 
-        WRITE_REGISTER_ULONG( (PULONG) &devExt->Regs->Int_Csr,
+        WRITE_REGISTER_ULONG( (PULONG) &DevExt->Regs->Int_Csr,
                               intCSR.ulong );
     }
 
     //
     // DMA 1 Descriptor Pointer Register - (DMADPR1)
-    // Write the base LOGICAL address of the DMA_TRANSFER_ELEMENT list.
+    // Write the base LOGICAL address of this slot's DMA_TRANSFER_ELEMENT list.
     //
     {
         union {
@@ -346,14 +427,14 @@ Return Value:
         ptr.bits.DescLocation = DESC_PTR_DESC_LOCATION__PCI;
         ptr.bits.TermCountInt = TRUE;
         ptr.bits.Address      =
-            DESC_PTR_ADDR( devExt->ReadCommonBufferBaseLA.LowPart );
+            DESC_PTR_ADDR( Slot->DteLA.LowPart );
 
-        WRITE_REGISTER_ULONG( (PULONG) &devExt->Regs->Dma1_Desc_Ptr,
+        WRITE_REGISTER_ULONG( (PULONG) &DevExt->Regs->Dma1_Desc_Ptr,
                               ptr.ulong );
     }
 
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_READ,
-                "    PLxEvtProgramReadDma: Start a Read DMA operation");
+                "    PLxStartReadDma: Start a Read DMA operation");
 
     //
     // DMA 1 CSR Register - (DMACSR1)
@@ -366,45 +447,14 @@ Return Value:
         } dmaCSR;
 
         dmaCSR.uchar =
-            READ_REGISTER_UCHAR( (PUCHAR) &devExt->Regs->Dma1_Csr );
+            READ_REGISTER_UCHAR( (PUCHAR) &DevExt->Regs->Dma1_Csr );
 
         dmaCSR.bits.Enable = TRUE;
         dmaCSR.bits.Start  = TRUE;
 
-        WRITE_REGISTER_UCHAR( (PUCHAR) &devExt->Regs->Dma1_Csr,
+        WRITE_REGISTER_UCHAR( (PUCHAR) &DevExt->Regs->Dma1_Csr,
                               dmaCSR.uchar );
     }
-
-    //
-    // Release our interrupt spinlock
-    //
-    WdfInterruptReleaseLock( devExt->Interrupt );
-
-    //
-    // NOTE: This shows how to process errors which occur in the
-    //       PFN_WDF_PROGRAM_DMA function in general.
-    //       Basically the DmaTransaction must be deleted and
-    //       the Request must be completed.
-    //
-    if (errors) {
-        NTSTATUS status;
-
-        //
-        // Must abort the transaction before deleting.
-        //
-        (VOID) WdfDmaTransactionDmaCompletedFinal(Transaction, 0, &status);
-        ASSERT(NT_SUCCESS(status));
-
-        PLxReadRequestComplete( Transaction, STATUS_INVALID_DEVICE_STATE );
-        TraceEvents(TRACE_LEVEL_ERROR, DBG_READ,
-                    "<-- PLxEvtProgramReadDma: errors ****");
-        return FALSE;
-    }
-
-    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_READ,
-                "<-- PLxEvtProgramReadDma");
-
-    return TRUE;
 }
 
 VOID
@@ -0,0 +1,1065 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    Stream.c
+
+Abstract:
+
+    Continuous acquisition on DMA channel 1 straight into a buffer that the
+    application passes with IOCTL_PLX_STREAM_START. The request stays
+    pending for as long as the stream runs. The DTE chain loops back on
+    itself, so the channel never stops; the ISR publishes a new producer
+    index every time a chunk has been filled.
+
+    Nothing is mapped into the application. The buffer is its own memory,
+    locked by the I/O manager for the life of the request, so whatever ends
+    the request - IOCTL_PLX_STREAM_STOP, cleanup of the handle, or the
+    cancel when the thread that sent it exits - only has to take the
+    channel off the pages before the request is completed.
+
+Environment:
+
+    Kernel mode
+
+--*/
+
+#include "precomp.h"
+
+#include "Stream.tmh"
+
+//
+// Number of 10 usec polls for the channel to report Done after an abort.
+//
+#define PLX_STREAM_ABORT_POLLS  100
+
+NTSTATUS
+PLxStreamStart(
+    IN  PDEVICE_EXTENSION DevExt,
+    IN  WDFREQUEST        Request
+    );
+
+NTSTATUS
+PLxStreamStopFile(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFFILEOBJECT     FileObject,
+    IN NTSTATUS          Status
+    );
+
+VOID
+PLxStreamStop(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFREQUEST        Request,
+    IN NTSTATUS          Status
+    );
+
+VOID
+PLxStreamRelease(
+    IN PDEVICE_EXTENSION DevExt
+    );
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text (PAGE, PLxStreamInitialize)
+#pragma alloc_text (PAGE, PLxStreamStart)
+#pragma alloc_text (PAGE, PLxStreamStopFile)
+#pragma alloc_text (PAGE, PLxEvtFileCleanup)
+#endif
+
+
+NTSTATUS
+PLxStreamInitialize(
+    IN PDEVICE_EXTENSION DevExt
+    )
+/*++
+Routine Description:
+
+    Called by PLxInitializeDeviceExtension, after PLxInitializeDMA, to set
+    up the stream state.
+
+Arguments:
+
+    DevExt      Pointer to our DEVICE_EXTENSION
+
+Return Value:
+
+    NTSTATUS code
+
+--*/
+{
+    NTSTATUS                status;
+    WDF_IO_QUEUE_CONFIG     queueConfig;
+    WDF_DMA_ENABLER_CONFIG  dmaConfig;
+
+    PAGED_CODE();
+
+    //
+    // The start request waits on this queue for as long as the stream
+    // runs. It keeps the buffer locked, and cancelling it stops the
+    // stream. It is not power managed: the stream keeps the device in D0,
+    // and a cancel must get through whatever the power state.
+    //
+    // IOCTLs are only enqueued once PLxEvtIoInCallerContext has started a
+    // stream for them, so they can all be dispatched to it.
+    //
+    WDF_IO_QUEUE_CONFIG_INIT( &queueConfig, WdfIoQueueDispatchManual );
+
+    queueConfig.PowerManaged         = WdfFalse;
+    queueConfig.EvtIoCanceledOnQueue = PLxEvtStreamCanceledOnQueue;
+
+    status = WdfIoQueueCreate( DevExt->Device,
+                               &queueConfig,
+                               WDF_NO_OBJECT_ATTRIBUTES,
+                               &DevExt->StreamQueue );
+
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_PNP,
+                    "WdfIoQueueCreate (stream) failed: %!STATUS!", status);
+        return status;
+    }
+
+    status = WdfDeviceConfigureRequestDispatching( DevExt->Device,
+                                                   DevExt->StreamQueue,
+                                                   WdfRequestTypeDeviceControl);
+
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_PNP,
+                    "DeviceConfigureRequestDispatching failed: %!STATUS!", status);
+        return status;
+    }
+
+    //
+    // The stream is one transfer over the whole buffer, which must not be
+    // split into fragments the way reads are split at MaximumTransferLength,
+    // so it gets an enabler of its own.
+    //
+    WDF_DMA_ENABLER_CONFIG_INIT( &dmaConfig,
+                                 WdfDmaProfileScatterGather64Duplex,
+                                 PLX_STREAM_MAXIMUM_LENGTH );
+
+    status = WdfDmaEnablerCreate( DevExt->Device,
+                                  &dmaConfig,
+                                  WDF_NO_OBJECT_ATTRIBUTES,
+                                  &DevExt->StreamDmaEnabler );
+
+    if (!NT_SUCCESS (status)) {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_PNP,
+                    "WdfDmaEnablerCreate (stream) failed: %!STATUS!", status);
+        return status;
+    }
+
+    status = WdfDmaTransactionCreate( DevExt->StreamDmaEnabler,
+                                      WDF_NO_OBJECT_ATTRIBUTES,
+                                      &DevExt->StreamDmaTransaction );
+
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_PNP,
+                    "WdfDmaTransactionCreate (stream) failed: %!STATUS!", status);
+        return status;
+    }
+
+    KeInitializeEvent( &DevExt->StreamProgrammed, NotificationEvent, FALSE );
+
+    DevExt->StreamDteBuffer   = NULL;
+    DevExt->StreamDteCapacity = 0;
+    DevExt->StreamDteCount    = 0;
+    DevExt->StreamHeaderMdl   = NULL;
+    DevExt->StreamHeader      = NULL;
+    DevExt->StreamClaimed     = FALSE;
+    DevExt->StreamRunning     = FALSE;
+
+    return status;
+}
+
+VOID
+PLxEvtIoInCallerContext(
+    IN WDFDEVICE  Device,
+    IN WDFREQUEST Request
+    )
+/*++
+
+Routine Description:
+
+    The stream IOCTLs are handled here rather than on a queue, because
+    starting a stream allocates and waits at PASSIVE_LEVEL, and the device
+    synchronization scope runs queue callbacks at DISPATCH_LEVEL.
+    Everything else goes to the queues as usual.
+
+Arguments:
+
+    Device     - Handle to the framework device object
+    Request    - Handle to a framework request object
+
+Return Value:
+
+--*/
+{
+    NTSTATUS                status;
+    PDEVICE_EXTENSION       devExt;
+    WDF_REQUEST_PARAMETERS  params;
+
+    devExt = PLxGetDeviceContext(Device);
+
+    WDF_REQUEST_PARAMETERS_INIT(&params);
+    WdfRequestGetParameters(Request, &params);
+
+    if (params.Type != WdfRequestTypeDeviceControl) {
+
+        status = WdfDeviceEnqueueRequest(Device, Request);
+
+        if (!NT_SUCCESS(status)) {
+            WdfRequestComplete(Request, status);
+        }
+        return;
+    }
+
+    if (KeGetCurrentIrql() != PASSIVE_LEVEL) {
+        WdfRequestComplete(Request, STATUS_INVALID_DEVICE_REQUEST);
+        return;
+    }
+
+    switch (params.Parameters.DeviceIoControl.IoControlCode) {
+
+    case IOCTL_PLX_STREAM_START:
+        status = PLxStreamStart(devExt, Request);
+        break;
+
+    case IOCTL_PLX_STREAM_STOP:
+        status = PLxStreamStopFile(devExt,
+                                   WdfRequestGetFileObject(Request),
+                                   STATUS_SUCCESS);
+        break;
+
+    default:
+        status = STATUS_INVALID_DEVICE_REQUEST;
+        break;
+    }
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_IOCTLS,
+                "PLxEvtIoInCallerContext: Request %p, %!STATUS!",
+                Request, status);
+
+    if (status != STATUS_PENDING) {
+        WdfRequestComplete(Request, status);
+    }
+}
+
+VOID
+PLxEvtFileCleanup(
+    IN WDFFILEOBJECT FileObject
+    )
+/*++
+
+Routine Description:
+
+    Called when the last handle to the file object is closed. Stop a
+    stream that is still running on it. This may be in any process, as
+    handles can be duplicated or inherited; that does not matter, since
+    completing the request is all it takes to give the buffer back.
+
+Arguments:
+
+    FileObject - Handle to the framework file object
+
+Return Value:
+
+--*/
+{
+    PDEVICE_EXTENSION devExt;
+
+    PAGED_CODE();
+
+    devExt = PLxGetDeviceContext(WdfFileObjectGetDevice(FileObject));
+
+    (VOID) PLxStreamStopFile(devExt, FileObject, STATUS_CANCELLED);
+}
+
+VOID
+PLxEvtStreamCanceledOnQueue(
+    IN WDFQUEUE   Queue,
+    IN WDFREQUEST Request
+    )
+/*++
+
+Routine Description:
+
+    Called when the start request is cancelled: by CancelIo, or by the I/O
+    manager when the thread that sent it exits. The process, and with it
+    the buffer, is still there until the request completes.
+
+Arguments:
+
+    Queue      - Handle to the stream queue
+    Request    - The IOCTL_PLX_STREAM_START request
+
+Return Value:
+
+--*/
+{
+    PLxStreamStop(PLxGetDeviceContext(WdfIoQueueGetDevice(Queue)),
+                  Request,
+                  STATUS_CANCELLED);
+}
+
+NTSTATUS
+PLxStreamStart(
+    IN  PDEVICE_EXTENSION DevExt,
+    IN  WDFREQUEST        Request
+    )
+/*++
+Routine Description:
+
+    Build a circular DTE chain over the buffer of the request, start DMA
+    channel 1 around it and park the request on the stream queue.
+
+Arguments:
+
+    DevExt      Pointer to our DEVICE_EXTENSION
+    Request     IOCTL_PLX_STREAM_START request
+
+Return Value:
+
+    STATUS_PENDING if the request now belongs to the stream queue;
+    otherwise the caller completes it with the returned status.
+
+--*/
+{
+    NTSTATUS                status;
+    PPLX_STREAM_START       start;
+    PMDL                    mdl;
+    PMDL                    headerMdl = NULL;
+    PUCHAR                  bufferVA;
+    ULONG                   chunkSize;
+    ULONG                   chunkCount;
+    size_t                  bufferLength;
+    size_t                  dataLength;
+    ULONG                   dteCapacity;
+    BOOLEAN                 claimed = FALSE;
+    BOOLEAN                 initialized = FALSE;
+
+    PAGED_CODE();
+
+    status = WdfRequestRetrieveInputBuffer(Request,
+                                           sizeof(PLX_STREAM_START),
+                                           &start,
+                                           NULL);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    chunkSize  = start->ChunkSize;
+    chunkCount = start->ChunkCount;
+
+    if (chunkCount < 2 || chunkCount > PLX_STREAM_MAXIMUM_CHUNKS ||
+        chunkSize == 0 || (chunkSize % sizeof(ULONG)) != 0 ||
+        chunkSize > PLX_STREAM_MAXIMUM_LENGTH / chunkCount) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    status = WdfRequestRetrieveOutputWdmMdl(Request, &mdl);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    //
+    // The header has the first page of the buffer to itself and the
+    // chunks follow it back to back.
+    //
+    dataLength   = (size_t) chunkSize * chunkCount;
+    bufferLength = MmGetMdlByteCount(mdl);
+    bufferVA     = (PUCHAR) MmGetMdlVirtualAddress(mdl);
+
+    if (bufferLength < PLX_STREAM_BUFFER_SIZE(chunkSize, chunkCount)) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    //
+    // Each chunk needs a DTE of its own, and so does every page boundary
+    // inside the data.
+    //
+    dteCapacity = chunkCount +
+                  ADDRESS_AND_SIZE_TO_SPAN_PAGES(bufferVA + PLX_STREAM_HEADER_SIZE, dataLength);
+
+    //
+    // Keep the device in D0 for as long as the stream runs.
+    //
+    status = WdfDeviceStopIdle(DevExt->Device, TRUE);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    //
+    // Claim the read channel. New reads are turned away from here on; the
+    // stream can only start once the reads in flight have drained. Only
+    // one stream runs at a time, and the claim is what says so.
+    //
+    WdfInterruptAcquireLock( DevExt->Interrupt );
+
+    if (!DevExt->StreamClaimed && DevExt->ReadRing.Count == 0) {
+        DevExt->StreamClaimed = TRUE;
+        claimed = TRUE;
+    }
+
+    WdfInterruptReleaseLock( DevExt->Interrupt );
+
+    if (!claimed) {
+        status = STATUS_DEVICE_BUSY;
+        goto CleanUp;
+    }
+
+    //
+    // The chain lives in a common buffer that is kept from one stream to
+    // the next, and only grown when a stream needs more DTEs. Nothing can
+    // be using it while the claim is held.
+    //
+    if (DevExt->StreamDteCapacity < dteCapacity) {
+
+        if (DevExt->StreamDteBuffer != NULL) {
+            WdfObjectDelete(DevExt->StreamDteBuffer);
+            DevExt->StreamDteBuffer   = NULL;
+            DevExt->StreamDteCapacity = 0;
+        }
+
+        status = WdfCommonBufferCreate( DevExt->StreamDmaEnabler,
+                                        sizeof(DMA_TRANSFER_ELEMENT) * dteCapacity,
+                                        WDF_NO_OBJECT_ATTRIBUTES,
+                                        &DevExt->StreamDteBuffer );
+
+        if (!NT_SUCCESS(status)) {
+            TraceEvents(TRACE_LEVEL_ERROR, DBG_IOCTLS,
+                        "WdfCommonBufferCreate (stream) failed: %!STATUS!", status);
+            goto CleanUp;
+        }
+
+        DevExt->StreamDteCapacity = dteCapacity;
+        DevExt->StreamDteVA =
+            WdfCommonBufferGetAlignedVirtualAddress(DevExt->StreamDteBuffer);
+        DevExt->StreamDteLA =
+            WdfCommonBufferGetAlignedLogicalAddress(DevExt->StreamDteBuffer);
+    }
+
+    //
+    // The ISR updates the header, so it needs a system address for it;
+    // a partial MDL keeps that to the one page.
+    //
+    headerMdl = IoAllocateMdl(bufferVA, sizeof(PLX_STREAM_HEADER), FALSE, FALSE, NULL);
+    if (headerMdl == NULL) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CleanUp;
+    }
+
+    IoBuildPartialMdl(mdl, headerMdl, bufferVA, sizeof(PLX_STREAM_HEADER));
+
+    DevExt->StreamHeader =
+        MmGetSystemAddressForMdlSafe(headerMdl, NormalPagePriority | MdlMappingNoExecute);
+
+    if (DevExt->StreamHeader == NULL) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CleanUp;
+    }
+
+    DevExt->StreamHeaderMdl = headerMdl;
+    headerMdl = NULL;
+
+    RtlZeroMemory(DevExt->StreamHeader, sizeof(PLX_STREAM_HEADER));
+
+    DevExt->StreamHeader->ChunkSize  = chunkSize;
+    DevExt->StreamHeader->ChunkCount = chunkCount;
+    DevExt->StreamHeader->DataOffset = PLX_STREAM_HEADER_SIZE;
+
+    DevExt->StreamChunkSize  = chunkSize;
+    DevExt->StreamChunkCount = chunkCount;
+
+    //
+    // Map the data for the device and let PLxEvtProgramStreamDma build the
+    // chain and start the channel. That can happen later, out of another
+    // context, if the adapter is short of map registers.
+    //
+    status = WdfDmaTransactionInitialize( DevExt->StreamDmaTransaction,
+                                          PLxEvtProgramStreamDma,
+                                          WdfDmaDirectionReadFromDevice,
+                                          mdl,
+                                          bufferVA + PLX_STREAM_HEADER_SIZE,
+                                          dataLength );
+
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_IOCTLS,
+                    "WdfDmaTransactionInitialize (stream) failed: %!STATUS!", status);
+        goto CleanUp;
+    }
+
+    initialized = TRUE;
+
+    KeClearEvent(&DevExt->StreamProgrammed);
+
+    status = WdfDmaTransactionExecute( DevExt->StreamDmaTransaction,
+                                       WDF_NO_CONTEXT );
+
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_IOCTLS,
+                    "WdfDmaTransactionExecute (stream) failed: %!STATUS!", status);
+        goto CleanUp;
+    }
+
+    KeWaitForSingleObject(&DevExt->StreamProgrammed,
+                          Executive,
+                          KernelMode,
+                          FALSE,
+                          NULL);
+
+    status = DevExt->StreamProgramStatus;
+
+    if (!NT_SUCCESS(status)) {
+        goto CleanUp;
+    }
+
+    //
+    // From here on the request owns the stream: anything that takes it
+    // off the queue, including a cancel that already happened, stops it.
+    //
+    status = WdfDeviceEnqueueRequest(DevExt->Device, Request);
+
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_IOCTLS,
+                    "WdfDeviceEnqueueRequest (stream) failed: %!STATUS!", status);
+        PLxStreamRelease(DevExt);
+        return status;
+    }
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_IOCTLS,
+                "PLxStreamStart: %d chunks of %d bytes in %d DTEs",
+                chunkCount, chunkSize, DevExt->StreamDteCount);
+
+    return STATUS_PENDING;
+
+CleanUp:
+
+    if (headerMdl != NULL) {
+        IoFreeMdl(headerMdl);
+    }
+
+    if (claimed) {
+
+        //
+        // The chain never got on the channel, so there is no DMA to
+        // finish, only the mapping to give back.
+        //
+        if (initialized) {
+            WdfDmaTransactionRelease(DevExt->StreamDmaTransaction);
+        }
+
+        if (DevExt->StreamHeaderMdl != NULL) {
+            MmPrepareMdlForReuse(DevExt->StreamHeaderMdl);
+            IoFreeMdl(DevExt->StreamHeaderMdl);
+        }
+
+        DevExt->StreamHeaderMdl = NULL;
+        DevExt->StreamHeader    = NULL;
+
+        WdfInterruptAcquireLock( DevExt->Interrupt );
+        DevExt->StreamClaimed = FALSE;
+        WdfInterruptReleaseLock( DevExt->Interrupt );
+    }
+
+    WdfDeviceResumeIdle(DevExt->Device);
+
+    return status;
+}
+
+BOOLEAN
+PLxEvtProgramStreamDma(
+    IN  WDFDMATRANSACTION       Transaction,
+    IN  WDFDEVICE               Device,
+    IN  WDFCONTEXT              Context,
+    IN  WDF_DMA_DIRECTION       Direction,
+    IN  PSCATTER_GATHER_LIST    SgList
+    )
+/*++
+
+Routine Description:
+
+    Translate the scatter/gather list of the stream buffer into one
+    circular DTE chain and start DMA channel 1 on it. The list covers the
+    whole buffer, since the stream enabler allows transfers of
+    PLX_STREAM_MAXIMUM_LENGTH.
+
+    A chunk can span several list elements, and an element several
+    chunks, so elements are split at chunk boundaries and only the DTE
+    that ends a chunk raises a terminal-count interrupt.
+
+Arguments:
+
+Return Value:
+
+    TRUE if the channel was started.
+
+--*/
+{
+    PDEVICE_EXTENSION       devExt;
+    PDMA_TRANSFER_ELEMENT   dteVA;
+    ULONG                   dteCount = 0;
+    ULONG                   chunkLeft;
+    size_t                  covered = 0;
+    ULONG                   i;
+
+    UNREFERENCED_PARAMETER( Context );
+    UNREFERENCED_PARAMETER( Direction );
+
+    devExt = PLxGetDeviceContext(Device);
+
+    dteVA     = devExt->StreamDteVA;
+    chunkLeft = devExt->StreamChunkSize;
+
+    for (i = 0; i < SgList->NumberOfElements; i++) {
+
+        PHYSICAL_ADDRESS address = SgList->Elements[i].Address;
+        ULONG            length  = SgList->Elements[i].Length;
+
+        while (length != 0 && dteCount < devExt->StreamDteCapacity) {
+
+            ULONG size = min(length, chunkLeft);
+
+            dteVA->PciAddressLow  = address.LowPart;
+            dteVA->PciAddressHigh = address.HighPart;
+            dteVA->TransferSize   = size;
+            dteVA->LocalAddress   = 0;
+
+            dteVA->DescPtr.DescLocation  = DESC_PTR_DESC_LOCATION__PCI;
+            dteVA->DescPtr.LastElement   = FALSE;
+            dteVA->DescPtr.DirOfTransfer = DESC_PTR_DIRECTION__FROM_DEVICE;
+            dteVA->DescPtr.Address       =
+                DESC_PTR_ADDR( devExt->StreamDteLA.LowPart +
+                               ((dteCount + 1) * sizeof(DMA_TRANSFER_ELEMENT)) );
+
+            chunkLeft -= size;
+
+            dteVA->DescPtr.TermCountInt = (chunkLeft == 0);
+
+            if (chunkLeft == 0) {
+                chunkLeft = devExt->StreamChunkSize;
+            }
+
+            address.QuadPart += size;
+            length  -= size;
+            covered += size;
+
+            dteVA++;
+            dteCount++;
+        }
+    }
+
+    if (covered != (size_t) devExt->StreamChunkSize * devExt->StreamChunkCount) {
+
+        NTSTATUS status;
+
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_IOCTLS,
+                    "PLxEvtProgramStreamDma: %d elements do not fit %d DTEs",
+                    SgList->NumberOfElements, devExt->StreamDteCapacity);
+
+        (VOID) WdfDmaTransactionDmaCompletedFinal(Transaction, 0, &status);
+
+        devExt->StreamProgramStatus = STATUS_INSUFFICIENT_RESOURCES;
+        KeSetEvent(&devExt->StreamProgrammed, IO_NO_INCREMENT, FALSE);
+
+        return FALSE;
+    }
+
+    //
+    // Close the loop: the last DTE points back at the first.
+    //
+    dteVA--;
+    dteVA->DescPtr.Address = DESC_PTR_ADDR( devExt->StreamDteLA.LowPart );
+
+    devExt->StreamDteCount = dteCount;
+
+    WdfInterruptAcquireLock( devExt->Interrupt );
+
+    PLxStartStreamDma(devExt);
+
+    WdfInterruptReleaseLock( devExt->Interrupt );
+
+    devExt->StreamProgramStatus = STATUS_SUCCESS;
+    KeSetEvent(&devExt->StreamProgrammed, IO_NO_INCREMENT, FALSE);
+
+    return TRUE;
+}
+
+NTSTATUS
+PLxStreamStopFile(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFFILEOBJECT     FileObject,
+    IN NTSTATUS          Status
+    )
+/*++
+Routine Description:
+
+    Stop the stream started on this file object, if there is one.
+
+Arguments:
+
+    DevExt          Pointer to our DEVICE_EXTENSION
+    FileObject      File object the stream was started on
+    Status          Completion status for the start request
+
+Return Value:
+
+    STATUS_INVALID_DEVICE_REQUEST if this file object owns no stream.
+
+--*/
+{
+    NTSTATUS   status;
+    WDFREQUEST request;
+
+    PAGED_CODE();
+
+    //
+    // Whoever takes the request off the queue stops the stream; a cancel
+    // racing with this either gets there first or not at all.
+    //
+    status = WdfIoQueueRetrieveRequestByFileObject(DevExt->StreamQueue,
+                                                   FileObject,
+                                                   &request);
+    if (!NT_SUCCESS(status)) {
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
+    PLxStreamStop(DevExt, request, Status);
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+PLxStreamStop(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFREQUEST        Request,
+    IN NTSTATUS          Status
+    )
+/*++
+Routine Description:
+
+    Stop the stream and complete its start request, which unlocks the
+    buffer. Called at IRQL <= DISPATCH_LEVEL by whoever took the request
+    off the stream queue.
+
+Arguments:
+
+    DevExt      Pointer to our DEVICE_EXTENSION
+    Request     The IOCTL_PLX_STREAM_START request
+    Status      Completion status for it
+
+Return Value:
+
+--*/
+{
+    PLxStreamRelease(DevExt);
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_IOCTLS,
+                "PLxStreamStop: Request %p, %!STATUS!", Request, Status);
+
+    WdfRequestComplete(Request, Status);
+}
+
+VOID
+PLxStreamRelease(
+    IN PDEVICE_EXTENSION DevExt
+    )
+/*++
+Routine Description:
+
+    Take the running stream off DMA channel 1 and off the buffer, and give
+    the channel back to reads. Must be done before the start request is
+    completed, since the buffer is unlocked then.
+
+Arguments:
+
+    DevExt      Pointer to our DEVICE_EXTENSION
+
+Return Value:
+
+--*/
+{
+    NTSTATUS status;
+
+    if (DevExt->StreamRunning) {
+        PLxStreamAbortDma(DevExt, TRUE);
+    }
+
+    DevExt->StreamDteCount = 0;
+
+    (VOID) WdfDmaTransactionDmaCompletedFinal(DevExt->StreamDmaTransaction, 0, &status);
+    WdfDmaTransactionRelease(DevExt->StreamDmaTransaction);
+
+    MmPrepareMdlForReuse(DevExt->StreamHeaderMdl);
+    IoFreeMdl(DevExt->StreamHeaderMdl);
+
+    DevExt->StreamHeaderMdl = NULL;
+    DevExt->StreamHeader    = NULL;
+
+    WdfInterruptAcquireLock( DevExt->Interrupt );
+    DevExt->StreamClaimed = FALSE;
+    WdfInterruptReleaseLock( DevExt->Interrupt );
+
+    WdfDeviceResumeIdle(DevExt->Device);
+}
+
+VOID
+PLxStartStreamDma(
+    IN PDEVICE_EXTENSION DevExt
+    )
+/*++
+Routine Description:
+
+    Put the circular stream chain on DMA channel 1 and start it.
+
+    Called with the interrupt spinlock held, or from D0Entry before the
+    interrupt is connected.
+
+Arguments:
+
+    DevExt      Pointer to our DEVICE_EXTENSION
+
+Return Value:
+
+--*/
+{
+    //
+    // DMA 1 Mode Register - (DMAMODE1)
+    // Scatter/Gather Mode and route Ints to PCI as for reads, but keep the
+    // local address constant (the data comes from a FIFO) and leave
+    // Clear-Count Mode off, or the chain would be used up after one lap.
+    //
+    {
+        union {
+            DMA_MODE  bits;
+            ULONG     ulong;
+        } dmaMode;
+
+        dmaMode.ulong =
+            READ_REGISTER_ULONG( (PULONG) &DevExt->Regs->Dma1_Mode );
+
+        dmaMode.bits.SgModeEnable     = TRUE;
+        dmaMode.bits.DoneIntEnable    = TRUE;
+        dmaMode.bits.IntToPci         = TRUE;
+        dmaMode.bits.LocalAddressMode = TRUE;
+
+        dmaMode.bits.ClearCountMode   = FALSE;
+
+        WRITE_REGISTER_ULONG( (PULONG) &DevExt->Regs->Dma1_Mode,
+                              dmaMode.ulong );
+    }
+
+    //
+    // Interrupt CSR Register - (INTCSR)
+    // Enable PCI Ints and DMA Channel 1 Ints.
+    //
+    {
+        union {
+            INT_CSR   bits;
+            ULONG     ulong;
+        } intCSR;
+
+        intCSR.ulong =
+            READ_REGISTER_ULONG( (PULONG) &DevExt->Regs->Int_Csr );
+
+        intCSR.bits.PciIntEnable      = TRUE;
+        intCSR.bits.DmaChan1IntEnable = TRUE;
+
+        WRITE_REGISTER_ULONG( (PULONG) &DevExt->Regs->Int_Csr,
+                              intCSR.ulong );
+    }
+
+    //
+    // DMA 1 Descriptor Pointer Register - (DMADPR1)
+    // Write the LOGICAL address of the first DTE of the circular chain.
+    //
+    {
+        union {
+            DESC_PTR  bits;
+            ULONG     ulong;
+        } ptr;
+
+        ptr.ulong = 0;
+        ptr.bits.DescLocation = DESC_PTR_DESC_LOCATION__PCI;
+        ptr.bits.TermCountInt = TRUE;
+        ptr.bits.Address      =
+            DESC_PTR_ADDR( DevExt->StreamDteLA.LowPart );
+
+        WRITE_REGISTER_ULONG( (PULONG) &DevExt->Regs->Dma1_Desc_Ptr,
+                              ptr.ulong );
+    }
+
+    DevExt->StreamRunning = TRUE;
+
+    //
+    // DMA 1 CSR Register - (DMACSR1)
+    // Start the DMA operation: Set Enable and Start bits.
+    //
+    {
+        union {
+            DMA_CSR  bits;
+            UCHAR    uchar;
+        } dmaCSR;
+
+        dmaCSR.uchar =
+            READ_REGISTER_UCHAR( (PUCHAR) &DevExt->Regs->Dma1_Csr );
+
+        dmaCSR.bits.Enable = TRUE;
+        dmaCSR.bits.Start  = TRUE;
+
+        WRITE_REGISTER_UCHAR( (PUCHAR) &DevExt->Regs->Dma1_Csr,
+                              dmaCSR.uchar );
+    }
+}
+
+VOID
+PLxStreamAbortDma(
+    IN PDEVICE_EXTENSION DevExt,
+    IN BOOLEAN           Synchronize
+    )
+/*++
+Routine Description:
+
+    Abort the circular chain running on DMA channel 1 and hand the channel
+    back to the read side in the state PLxStartReadDma expects.
+
+Arguments:
+
+    DevExt      Pointer to our DEVICE_EXTENSION
+    Synchronize TRUE to use the interrupt spinlock. FALSE from D0Exit,
+                where the interrupt is no longer connected.
+
+Return Value:
+
+--*/
+{
+    ULONG i;
+
+    union {
+        DMA_CSR  bits;
+        UCHAR    uchar;
+    } dmaCSR;
+
+    union {
+        DMA_MODE  bits;
+        ULONG     ulong;
+    } dmaMode;
+
+    if (Synchronize) {
+        WdfInterruptAcquireLock( DevExt->Interrupt );
+    }
+
+    DevExt->StreamRunning = FALSE;
+
+    //
+    // Interrupt CSR Register - (INTCSR)
+    // Mask channel 1 first, so the Done raised by the abort is not taken
+    // for the end of a read.
+    //
+    {
+        union {
+            INT_CSR   bits;
+            ULONG     ulong;
+        } intCSR;
+
+        intCSR.ulong =
+            READ_REGISTER_ULONG( (PULONG) &DevExt->Regs->Int_Csr );
+
+        intCSR.bits.DmaChan1IntEnable = FALSE;
+
+        WRITE_REGISTER_ULONG( (PULONG) &DevExt->Regs->Int_Csr,
+                              intCSR.ulong );
+    }
+
+    //
+    // The channel must be disabled before it can be aborted.
+    //
+    dmaCSR.uchar = READ_REGISTER_UCHAR( (PUCHAR) &DevExt->Regs->Dma1_Csr );
+    dmaCSR.bits.Enable = FALSE;
+    dmaCSR.bits.Start  = FALSE;
+    WRITE_REGISTER_UCHAR( (PUCHAR) &DevExt->Regs->Dma1_Csr, dmaCSR.uchar );
+
+    dmaCSR.bits.Abort = TRUE;
+    WRITE_REGISTER_UCHAR( (PUCHAR) &DevExt->Regs->Dma1_Csr, dmaCSR.uchar );
+
+    if (Synchronize) {
+        WdfInterruptReleaseLock( DevExt->Interrupt );
+    }
+
+    for (i = 0; i < PLX_STREAM_ABORT_POLLS; i++) {
+
+        dmaCSR.uchar = READ_REGISTER_UCHAR( (PUCHAR) &DevExt->Regs->Dma1_Csr );
+
+        if (dmaCSR.bits.Done) {
+            break;
+        }
+
+        KeStallExecutionProcessor(10);
+    }
+
+    if (!dmaCSR.bits.Done) {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_IOCTLS,
+                    "PLxStreamAbortDma: channel 1 did not stop");
+        DevExt->HwErrCount++;
+    }
+
+    if (Synchronize) {
+        WdfInterruptAcquireLock( DevExt->Interrupt );
+    }
+
+    dmaCSR.uchar = 0;
+    dmaCSR.bits.Clear = TRUE;
+    WRITE_REGISTER_UCHAR( (PUCHAR) &DevExt->Regs->Dma1_Csr, dmaCSR.uchar );
+
+    dmaMode.ulong = READ_REGISTER_ULONG( (PULONG) &DevExt->Regs->Dma1_Mode );
+    dmaMode.bits.LocalAddressMode = FALSE;
+    WRITE_REGISTER_ULONG( (PULONG) &DevExt->Regs->Dma1_Mode, dmaMode.ulong );
+
+    DevExt->Dma1Csr.uchar = 0;
+    DevExt->IntCsr.bits.DmaChan1IntActive = FALSE;
+
+    if (Synchronize) {
+        WdfInterruptReleaseLock( DevExt->Interrupt );
+    }
+}
+
+VOID
+PLxStreamChunkDone(
+    IN PDEVICE_EXTENSION DevExt
+    )
+/*++
+Routine Description:
+
+    Called by the ISR for every channel 1 interrupt while the stream runs.
+    Publish the chunk that was just filled.
+
+Arguments:
+
+    DevExt      Pointer to our DEVICE_EXTENSION
+
+Return Value:
+
+--*/
+{
+    PPLX_STREAM_HEADER header = DevExt->StreamHeader;
+    LONG               produced;
+
+    //
+    // The interlocked increment also orders the chunk data ahead of the
+    // new index for the consumer.
+    //
+    produced = InterlockedIncrement(&header->ProducerIndex);
+
+    //
+    // ConsumerIndex belongs to the application, so only ever use it for
+    // bookkeeping.
+    //
+    if ((ULONG) (produced - header->ConsumerIndex) > DevExt->StreamChunkCount) {
+        header->Overruns++;
+    }
+}
@@ -61,6 +61,7 @@ Return Value:
 {
     NTSTATUS          status = STATUS_UNSUCCESSFUL;
     PDEVICE_EXTENSION devExt = NULL;
+    PDMA_RING_SLOT    slot = NULL;
 
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_WRITE,
                 "--> PLxEvtIoWrite: Request %p", Request);
@@ -78,6 +79,12 @@ Return Value:
         goto CleanUp;
     }
 
+    //
+    // Take the next write ring slot. The queue never presents more
+    // requests than there are slots.
+    //
+    slot = PLxDmaRingReserve( devExt, &devExt->WriteRing );
+
     //
     // Following code illustrates two different ways of initializing a DMA
     // transaction object. If ASSOC_WRITE_REQUEST_WITH_DMA_TRANSACTION is
@@ -92,7 +99,7 @@ Return Value:
     // for handling client Requests.
     //
     status = WdfDmaTransactionInitializeUsingRequest(
-                                           devExt->WriteDmaTransaction,
+                                           slot->DmaTransaction,
                                            Request,
                                            PLxEvtProgramWriteDma,
                                            WdfDmaDirectionWriteToDevice );
@@ -140,7 +147,7 @@ Return Value:
         length = MmGetMdlByteCount(mdl);
 
         _Analysis_assume_(length > 0);
-        status = WdfDmaTransactionInitialize( devExt->WriteDmaTransaction,
+        status = WdfDmaTransactionInitialize( slot->DmaTransaction,
                                               PLxEvtProgramWriteDma,
                                               WdfDmaDirectionWriteToDevice,
                                               mdl,
@@ -157,7 +164,7 @@ Return Value:
         // Retreive this DmaTransaction's context ptr (aka TRANSACTION_CONTEXT)
         // and fill it in with info.
         //
-        transContext = PLxGetTransactionContext( devExt->WriteDmaTransaction );
+        transContext = PLxGetTransactionContext( slot->DmaTransaction );
         transContext->Request = Request;
     }
 #endif
@@ -175,14 +182,14 @@ Return Value:
             //TraceEvents(TRACE_LEVEL_INFORMATION, DBG_WRITE,
             //            "Setting a new MaxLen %d", length);
 
-            WdfDmaTransactionSetMaximumLength( devExt->WriteDmaTransaction, length );
+            WdfDmaTransactionSetMaximumLength( slot->DmaTransaction, length );
         }
 #endif
 
     //
     // Execute this DmaTransaction transaction.
     //
-    status = WdfDmaTransactionExecute( devExt->WriteDmaTransaction, 
+    status = WdfDmaTransactionExecute( slot->DmaTransaction, 
                                        WDF_NO_CONTEXT);
 
     if(!NT_SUCCESS(status)) {
@@ -207,7 +214,14 @@ CleanUp:
     // If there are errors, then clean up and complete the Request.
     //
     if (!NT_SUCCESS(status)) {
-        WdfDmaTransactionRelease(devExt->WriteDmaTransaction);        
+        if (slot != NULL) {
+            WdfDmaTransactionRelease(slot->DmaTransaction);        
+
+            //
+            // The slot never reached the channel; let the ring skip it.
+            //
+            PLxDmaRingSlotReady( devExt, &devExt->WriteRing, slot, FALSE );
+        }
         WdfRequestComplete(Request, status);
     }
 
@@ -239,6 +253,7 @@ Return Value:
 --*/
 {
     PDEVICE_EXTENSION        devExt;
+    PDMA_RING_SLOT           slot;
     size_t                   offset;
     PDMA_TRANSFER_ELEMENT    dteVA;
     ULONG_PTR                dteLA;
@@ -255,8 +270,11 @@ Return Value:
     // Initialize locals
     //
     devExt = PLxGetDeviceContext(Device);
+    slot = PLxGetTransactionContext(Transaction)->Slot;
     errors = FALSE;
 
+    ASSERT(slot->State == DmaSlotReserved);
+
     //
     // Get the number of bytes as the offset to the beginning of this
     // Dma operations transfer location in the buffer.
@@ -267,8 +285,8 @@ Return Value:
     // Setup the pointer to the next DMA_TRANSFER_ELEMENT
     // for both virtual and physical address references.
     //
-    dteVA = (PDMA_TRANSFER_ELEMENT) devExt->WriteCommonBufferBase;
-    dteLA = (devExt->WriteCommonBufferBaseLA.LowPart +
+    dteVA = slot->DteVA;
+    dteLA = (slot->DteLA.LowPart +
                         sizeof(DMA_TRANSFER_ELEMENT));
 
     //
@@ -347,11 +365,65 @@ Return Value:
     }
 
     //
-    // Start the DMA operation.
-    // Acquire this device's InterruptSpinLock.
+    // The chain is complete. Start it now if the channel is idle and this
+    // slot is next in line, otherwise the DPC starts it when its turn comes.
+    //
+    if (!errors) {
+        PLxDmaRingSlotReady( devExt, &devExt->WriteRing, slot, TRUE );
+    }
+
+    //
+    // NOTE: This shows how to process errors which occur in the
+    //       PFN_WDF_PROGRAM_DMA function in general.
+    //       Basically the DmaTransaction must be deleted and
+    //       the Request must be completed.
     //
-    WdfInterruptAcquireLock( devExt->Interrupt );
+    if (errors) {
+        //
+        // Must abort the transaction before deleting it.
+        //
+        NTSTATUS status;
+
+        (VOID) WdfDmaTransactionDmaCompletedFinal(Transaction, 0, &status);
+        ASSERT(NT_SUCCESS(status));
+        PLxDmaRingSlotReady( devExt, &devExt->WriteRing, slot, FALSE );
+        PLxWriteRequestComplete( Transaction, STATUS_INVALID_DEVICE_STATE );
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_WRITE,
+                    "<-- PLxEvtProgramWriteDma: error ****");
+        return FALSE;
+    }
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_WRITE,
+                "<-- PLxEvtProgramWriteDma");
+
+    return TRUE;
+}
+
+
+VOID
+PLxStartWriteDma(
+    IN PDEVICE_EXTENSION DevExt,
+    IN PDMA_RING_SLOT    Slot
+    )
+/*++
+
+Routine Description:
+
+    Put the DTE chain of this write ring slot on DMA channel 0 and start it.
+
+    Called with the interrupt spinlock held, either from
+    PLxEvtProgramWriteDma when the channel is idle or from the DPC when
+    the previous chain is done.
+
+Arguments:
 
+    DevExt     Pointer to Device Extension
+    Slot       Write ring slot whose chain is to be started
+
+Return Value:
+
+--*/
+{
     //
     // DMA 0 Mode Register - (DMAMODE0)
     // Enable Scatter/Gather Mode, Interrupt On Done,
@@ -364,13 +436,13 @@ Return Value:
         } dmaMode;
 
         dmaMode.ulong =
-            READ_REGISTER_ULONG( (PULONG) &devExt->Regs->Dma0_Mode );
+            READ_REGISTER_ULONG( (PULONG) &DevExt->Regs->Dma0_Mode );
 
         dmaMode.bits.SgModeEnable  = TRUE;
         dmaMode.bits.DoneIntEnable = TRUE;
         dmaMode.bits.IntToPci      = TRUE;
 
-        WRITE_REGISTER_ULONG( (PULONG) &devExt->Regs->Dma0_Mode,
+        WRITE_REGISTER_ULONG( (PULONG) &DevExt->Regs->Dma0_Mode,
                               dmaMode.ulong );
     }
 
@@ -385,18 +457,18 @@ Return Value:
         } intCSR;
 
         intCSR.ulong =
-            READ_REGISTER_ULONG( (PULONG) &devExt->Regs->Int_Csr );
+            READ_REGISTER_ULONG( (PULONG) &DevExt->Regs->Int_Csr );
 
         intCSR.bits.PciIntEnable      = TRUE;
         intCSR.bits.DmaChan0IntEnable = TRUE;
 
-        WRITE_REGISTER_ULONG( (PULONG) &devExt->Regs->Int_Csr,
+        WRITE_REGISTER_ULONG( (PULONG) &DevExt->Regs->Int_Csr,
                               intCSR.ulong );
     }
 
     //
     // DMA 0 Descriptor Pointer Register - (DMADPR0)
-    // Write the base LOGICAL address of the DMA_TRANSFER_ELEMENT list.
+    // Write the base LOGICAL address of this slot's DMA_TRANSFER_ELEMENT list.
     //
     {
         union {
@@ -407,14 +479,14 @@ Return Value:
         ptr.bits.DescLocation = DESC_PTR_DESC_LOCATION__PCI;
         ptr.bits.TermCountInt = TRUE;
         ptr.bits.Address      =
-            DESC_PTR_ADDR( devExt->WriteCommonBufferBaseLA.LowPart );
+            DESC_PTR_ADDR( Slot->DteLA.LowPart );
 
-        WRITE_REGISTER_ULONG( (PULONG) &devExt->Regs->Dma0_Desc_Ptr,
+        WRITE_REGISTER_ULONG( (PULONG) &DevExt->Regs->Dma0_Desc_Ptr,
                               ptr.ulong );
     }
 
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_WRITE,
-                "    PLxEvtProgramWriteDma: Start a Write DMA operation");
+                "    PLxStartWriteDma: Start a Write DMA operation");
 
     //
     // DMA 0 CSR Register - (DMACSR0)
@@ -427,47 +499,16 @@ Return Value:
         } dmaCSR;
 
         dmaCSR.uchar =
-            READ_REGISTER_UCHAR( (PUCHAR) &devExt->Regs->Dma0_Csr );
+            READ_REGISTER_UCHAR( (PUCHAR) &DevExt->Regs->Dma0_Csr );
 
         dmaCSR.bits.Enable = TRUE;
         dmaCSR.bits.Start  = TRUE;
 
-        WRITE_REGISTER_UCHAR( (PUCHAR) &devExt->Regs->Dma0_Csr,
+        WRITE_REGISTER_UCHAR( (PUCHAR) &DevExt->Regs->Dma0_Csr,
                               dmaCSR.uchar );
     }
-
-    //
-    // Release our interrupt spinlock
-    //
-    WdfInterruptReleaseLock( devExt->Interrupt );
-
-    //
-    // NOTE: This shows how to process errors which occur in the
-    //       PFN_WDF_PROGRAM_DMA function in general.
-    //       Basically the DmaTransaction must be deleted and
-    //       the Request must be completed.
-    //
-    if (errors) {
-        //
-        // Must abort the transaction before deleting it.
-        //
-        NTSTATUS status;
-
-        (VOID) WdfDmaTransactionDmaCompletedFinal(Transaction, 0, &status);
-        ASSERT(NT_SUCCESS(status));
-        PLxWriteRequestComplete( Transaction, STATUS_INVALID_DEVICE_STATE );
-        TraceEvents(TRACE_LEVEL_ERROR, DBG_WRITE,
-                    "<-- PLxEvtProgramWriteDma: error ****");
-        return FALSE;
-    }
-
-    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_WRITE,
-                "<-- PLxEvtProgramWriteDma");
-
-    return TRUE;
 }
 
-
 VOID
 PLxWriteRequestComplete(
     IN WDFDMATRANSACTION  DmaTransaction,
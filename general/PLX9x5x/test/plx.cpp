@@ -14,6 +14,8 @@ Abstract:
         plx.exe /wr /wb=100         # write-then-read once with a buffer of 100 bytes
         plx.exe /thread             # repeat write-then-read for default 5000 millisecs.
         plx.exe /thread /time=1000  # repeat write-then-read for 1000 millisecs.
+        plx.exe /tput /depth=8      # write then read throughput, 8 requests in flight
+        plx.exe /stream /rb=4096    # consume a mapped DMA stream of 4096 byte chunks
 
     NOTE: The /quite option will suppress most non-error messages.
     NOTE: The options and parameters are case sensitive.
@@ -192,6 +194,27 @@ main(
 
                 test = THREAD_TEST;
 
+            } else if(strcmp(command, "tput") == 0) {
+
+                test = THROUGHPUT_TEST;
+
+            } else if(strcmp(command, "stream") == 0) {
+
+                test = STREAM_TEST;
+
+            } else if (strcmp(command, "depth") == 0) {
+
+                data = strtok_s(NULL, delims2, &state);
+
+                if (!data && i < argc-1) {
+                    data = argv[++i];
+                }
+
+                ULONG depth = (NULL != data) ? atol(data) : 0;
+                if (!Plx.SetQueueDepth(depth)) {
+                    status = FALSE;
+                }
+
             } else if (strcmp(command, "time") == 0) {
 
                 data = strtok_s(NULL, delims, &state);
@@ -236,6 +259,14 @@ main(
                 Plx.ThreadedReadWriteTest();
                 break;
 
+            case THROUGHPUT_TEST:
+                Plx.ThroughputTest();
+                break;
+
+            case STREAM_TEST:
+                Plx.StreamTest();
+                break;
+
             case MENU_TEST:
             default:
                 Plx.Menu();
@@ -263,6 +294,7 @@ PLX::PLX()
     ProcessorCount = 0;
     CSInitialized = FALSE;
     ThreadTimer = 5000;  // 5000 milliseconds (5 seconds)
+    QueueDepth = DEFAULT_QUEUE_DEPTH;
 
     Quite = FALSE;
     Status = 0;
@@ -345,6 +377,9 @@ PLX::Menu()
                " 8- Display Read/Write Buffers\n"
                " 9- Change Thread Lifetime\n"
                "10- Command Line Options\n"
+               "11- Throughput Test\n"
+               "12- Change Throughput Queue Depth\n"
+               "13- Stream Test\n"
                " 0- Quit\n");
 
         if (scanf_s("%d", &menu) == 0) {
@@ -403,7 +438,26 @@ PLX::Menu()
                        " Perform Write Test:             '/wt'\n"
                        " Perform Read Test:              '/rt'\n"
                        " Perform Read/Write Test:        '/wr'\n"
-                       " Perform Read/Write Thread Test: '/thread'\n");
+                       " Perform Read/Write Thread Test: '/thread'\n"
+                       " Perform Throughput Test:        '/tput'\n"
+                       " Set Throughput Queue Depth:     '/depth=xx'\n"
+                       " Perform Stream Test:            '/stream'\n");
+                break;
+
+            case THROUGHPUT_TEST:                       // 11
+                ThroughputTest();
+                break;
+
+            case QUEUE_DEPTH:                           // 12
+                ULONG depth;
+                printf("\nEnter new queue depth (1-%u): ", MAXIMUM_QUEUE_DEPTH);
+                if (scanf_s("%u", &depth) != 0) {
+                    SetQueueDepth(depth);
+                }
+                break;
+
+            case STREAM_TEST:                           // 13
+                StreamTest();
                 break;
 
             default:
@@ -1102,3 +1156,381 @@ PLX::SetThreadLifeTime(ULONG time)
     ThreadTimer = time;
 }
 
+
+BOOL
+PLX::SetQueueDepth(ULONG depth)
+{
+    if (depth == 0 || depth > MAXIMUM_QUEUE_DEPTH) {
+        printf("Queue depth must be between 1 and %u.\n", MAXIMUM_QUEUE_DEPTH);
+        return FALSE;
+    }
+
+    QueueDepth = depth;
+
+    return TRUE;
+}
+
+BOOL
+PLX::ThroughputTest()
+{
+    BOOL status = TRUE;
+    HANDLE hOverlapped;
+
+    if (pDeviceInterfaceDetail == NULL) {
+        status = GetDevicePath();
+    }
+    if (pDeviceInterfaceDetail == NULL) {
+        return FALSE;
+    }
+
+    //
+    //  The synchronous handle used by the other tests only ever has one
+    //  request outstanding, so open one for overlapped I/O.
+    //
+    hOverlapped = CreateFile(pDeviceInterfaceDetail->DevicePath,
+                             GENERIC_READ|GENERIC_WRITE,
+                             FILE_SHARE_READ | FILE_SHARE_WRITE,
+                             NULL,
+                             OPEN_EXISTING,
+                             FILE_FLAG_OVERLAPPED,
+                             NULL);
+
+    if (hOverlapped == INVALID_HANDLE_VALUE) {
+        printf("CreateFile failed.  Error:%u", GetLastError());
+        this->Status = 1;
+        return FALSE;
+    }
+
+    status = MeasureThroughput(hOverlapped, FALSE);
+    if (status) {
+        status = MeasureThroughput(hOverlapped, TRUE);
+    }
+
+    CloseHandle(hOverlapped);
+
+    return status;
+}
+
+BOOL
+PLX::MeasureThroughput(HANDLE hOverlapped, BOOL read)
+{
+    BOOL status = TRUE;
+    ULONG bufferSize = read ? ReadBufferSize : WriteBufferSize;
+    ULONG outstanding = 0;
+    ULONG i;
+    ULONGLONG requests = 0;
+    ULONGLONG bytesTotal = 0;
+    ULONGLONG start, elapsed;
+    PUCHAR buffers[MAXIMUM_QUEUE_DEPTH] = {0};
+    OVERLAPPED overlapped[MAXIMUM_QUEUE_DEPTH] = {0};
+    HANDLE events[MAXIMUM_QUEUE_DEPTH] = {0};
+    BOOL pending[MAXIMUM_QUEUE_DEPTH] = {0};
+
+    for (i = 0; i < QueueDepth; i++) {
+        buffers[i] = (PUCHAR)malloc(bufferSize);
+        events[i] = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+        if (buffers[i] == NULL || events[i] == NULL) {
+            printf("Insufficient resources.\n");
+            this->Status = 1;
+            status = FALSE;
+            goto Cleanup;
+        }
+
+        FillMemory(buffers[i], bufferSize, 0xAB);
+    }
+
+    start = GetTickCount64();
+
+    //
+    //  Keep QueueDepth requests in flight until the time is up. Each
+    //  completed request is reissued right away from the same slot.
+    //
+    for (i = 0; i < QueueDepth; i++) {
+        pending[i] = TRUE;
+        outstanding++;
+    }
+
+    while (outstanding > 0) {
+
+        DWORD wait;
+        DWORD bytes;
+
+        for (i = 0; i < QueueDepth; i++) {
+
+            if (!pending[i] || overlapped[i].hEvent != NULL) {
+                continue;
+            }
+
+            ZeroMemory(&overlapped[i], sizeof(OVERLAPPED));
+            overlapped[i].hEvent = events[i];
+
+            if (read) {
+                status = ReadFile(hOverlapped, buffers[i], bufferSize, NULL, &overlapped[i]);
+            } else {
+                status = WriteFile(hOverlapped, buffers[i], bufferSize, NULL, &overlapped[i]);
+            }
+
+            if (!status && GetLastError() != ERROR_IO_PENDING) {
+                printf("%s failed.  Error:%u\n", read ? "ReadFile" : "WriteFile", GetLastError());
+                this->Status = 1;
+                overlapped[i].hEvent = NULL;
+                pending[i] = FALSE;
+                outstanding--;
+            }
+            status = TRUE;
+        }
+
+        if (outstanding == 0) {
+            break;
+        }
+
+        wait = WaitForMultipleObjects(QueueDepth, events, FALSE, INFINITE);
+        if (wait >= WAIT_OBJECT_0 + QueueDepth) {
+            printf("WaitForMultipleObjects error %u\n", GetLastError());
+            this->Status = 1;
+            status = FALSE;
+            break;
+        }
+
+        i = wait - WAIT_OBJECT_0;
+
+        if (GetOverlappedResult(hOverlapped, &overlapped[i], &bytes, FALSE)) {
+            requests++;
+            bytesTotal += bytes;
+        } else {
+            printf("%s failed.  Error:%u\n", read ? "Read" : "Write", GetLastError());
+            this->Status = 1;
+            status = FALSE;
+        }
+
+        ResetEvent(events[i]);
+        overlapped[i].hEvent = NULL;
+
+        if (!status || GetTickCount64() - start >= ThreadTimer) {
+            pending[i] = FALSE;
+            outstanding--;
+        }
+    }
+
+    elapsed = GetTickCount64() - start;
+    if (elapsed == 0) {
+        elapsed = 1;
+    }
+
+    printf("%s: %I64u requests of %u bytes, depth %u, in %I64u ms: "
+           "%I64u requests/s, %.2f MB/s\n",
+           read ? "Read " : "Write",
+           requests,
+           bufferSize,
+           QueueDepth,
+           elapsed,
+           (requests * 1000) / elapsed,
+           ((double)bytesTotal * 1000.0) / ((double)elapsed * 1024.0 * 1024.0));
+
+Cleanup:
+
+    if (outstanding > 0) {
+        CancelIo(hOverlapped);
+        for (i = 0; i < QueueDepth; i++) {
+            if (overlapped[i].hEvent != NULL) {
+                DWORD bytes;
+                GetOverlappedResult(hOverlapped, &overlapped[i], &bytes, TRUE);
+            }
+        }
+    }
+
+    for (i = 0; i < QueueDepth; i++) {
+        if (events[i]) {
+            CloseHandle(events[i]);
+        }
+        if (buffers[i]) {
+            free(buffers[i]);
+        }
+    }
+
+    return status;
+}
+
+BOOL
+PLX::StreamTest()
+{
+    BOOL status = TRUE;
+    DWORD bytes = 0;
+    HANDLE hOverlapped;
+    PLX_STREAM_START start;
+    OVERLAPPED startOverlapped = {0};
+    OVERLAPPED stopOverlapped = {0};
+    size_t bufferSize;
+    volatile PLX_STREAM_HEADER *header = NULL;
+    PUCHAR data;
+    ULONGLONG chunks = 0;
+    ULONG checksum = 0;
+    ULONGLONG begin, elapsed;
+
+    if (pDeviceInterfaceDetail == NULL) {
+        status = GetDevicePath();
+    }
+    if (pDeviceInterfaceDetail == NULL) {
+        return FALSE;
+    }
+
+    //
+    //  The start request stays pending for as long as the stream runs, so
+    //  it needs a handle opened for overlapped I/O.
+    //
+    hOverlapped = CreateFile(pDeviceInterfaceDetail->DevicePath,
+                             GENERIC_READ|GENERIC_WRITE,
+                             FILE_SHARE_READ | FILE_SHARE_WRITE,
+                             NULL,
+                             OPEN_EXISTING,
+                             FILE_FLAG_OVERLAPPED,
+                             NULL);
+
+    if (hOverlapped == INVALID_HANDLE_VALUE) {
+        printf("CreateFile failed.  Error:%u", GetLastError());
+        this->Status = 1;
+        return FALSE;
+    }
+
+    start.ChunkSize  = ReadBufferSize;
+    start.ChunkCount = DEFAULT_STREAM_CHUNKS;
+
+    //
+    //  VirtualAlloc gives the page aligned buffer the driver wants.
+    //
+    bufferSize = PLX_STREAM_BUFFER_SIZE(start.ChunkSize, start.ChunkCount);
+
+    header = (volatile PLX_STREAM_HEADER *)VirtualAlloc(NULL,
+                                                        bufferSize,
+                                                        MEM_COMMIT | MEM_RESERVE,
+                                                        PAGE_READWRITE);
+    startOverlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    stopOverlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+    if (header == NULL || startOverlapped.hEvent == NULL || stopOverlapped.hEvent == NULL) {
+        printf("Insufficient resources.\n");
+        this->Status = 1;
+        status = FALSE;
+        goto Cleanup;
+    }
+
+    //
+    //  The request only completes once the stream has stopped, so
+    //  anything but ERROR_IO_PENDING means it did not start.
+    //
+    if (DeviceIoControl(hOverlapped,
+                        IOCTL_PLX_STREAM_START,
+                        &start,
+                        sizeof(start),
+                        (PVOID)header,
+                        (DWORD)bufferSize,
+                        NULL,
+                        &startOverlapped)) {
+        SetLastError(ERROR_GEN_FAILURE);
+    }
+
+    if (GetLastError() != ERROR_IO_PENDING) {
+        printf("IOCTL_PLX_STREAM_START failed.  Error:%u\n", GetLastError());
+        this->Status = 1;
+        status = FALSE;
+        goto Cleanup;
+    }
+
+    data = (PUCHAR)header + header->DataOffset;
+
+    if (!Quite) {
+        printf("Streaming %u chunks of %u bytes for %u ms...\n",
+               header->ChunkCount, header->ChunkSize, ThreadTimer);
+    }
+
+    //
+    //  No system calls from here on: the driver advances ProducerIndex
+    //  from its ISR and we hand chunks back by advancing ConsumerIndex.
+    //
+    begin = GetTickCount64();
+
+    while (GetTickCount64() - begin < ThreadTimer) {
+
+        LONG consumer = header->ConsumerIndex;
+
+        if (header->ProducerIndex == consumer) {
+            YieldProcessor();
+            continue;
+        }
+
+        //
+        //  Touch the chunk so the buffer is really being read.
+        //
+        checksum += *(volatile ULONG *)(data +
+            ((ULONG)consumer % header->ChunkCount) * header->ChunkSize);
+
+        MemoryBarrier();
+        header->ConsumerIndex = consumer + 1;
+        chunks++;
+    }
+
+    elapsed = GetTickCount64() - begin;
+    if (elapsed == 0) {
+        elapsed = 1;
+    }
+
+    printf("Stream: %I64u chunks of %u bytes in %I64u ms: "
+           "%I64u chunks/s, %.2f MB/s, %u overruns\n",
+           chunks,
+           header->ChunkSize,
+           elapsed,
+           (chunks * 1000) / elapsed,
+           ((double)chunks * header->ChunkSize * 1000.0) / ((double)elapsed * 1024.0 * 1024.0),
+           header->Overruns);
+
+    if (!Quite) {
+        printf("Checksum of first dwords: 0x%08x\n", checksum);
+    }
+
+    //
+    //  Stopping completes the start request.
+    //
+    if (!DeviceIoControl(hOverlapped,
+                         IOCTL_PLX_STREAM_STOP,
+                         NULL,
+                         0,
+                         NULL,
+                         0,
+                         NULL,
+                         &stopOverlapped) && GetLastError() != ERROR_IO_PENDING) {
+        printf("IOCTL_PLX_STREAM_STOP failed.  Error:%u\n", GetLastError());
+        this->Status = 1;
+        status = FALSE;
+
+    } else if (!GetOverlappedResult(hOverlapped, &stopOverlapped, &bytes, TRUE)) {
+        printf("IOCTL_PLX_STREAM_STOP failed.  Error:%u\n", GetLastError());
+        this->Status = 1;
+        status = FALSE;
+    }
+
+    //
+    //  The buffer is ours again once the start request has completed,
+    //  which closing the handle ensures if the stop did not.
+    //
+    if (!status) {
+        CancelIo(hOverlapped);
+    }
+    GetOverlappedResult(hOverlapped, &startOverlapped, &bytes, TRUE);
+
+Cleanup:
+
+    CloseHandle(hOverlapped);
+
+    if (header) {
+        VirtualFree((PVOID)header, 0, MEM_RELEASE);
+    }
+    if (startOverlapped.hEvent) {
+        CloseHandle(startOverlapped.hEvent);
+    }
+    if (stopOverlapped.hEvent) {
+        CloseHandle(stopOverlapped.hEvent);
+    }
+
+    return status;
+}
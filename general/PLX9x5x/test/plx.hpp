@@ -20,6 +20,7 @@ Environment:
 #pragma once
 
 #include <windows.h>
+#include <winioctl.h>
 #include <setupapi.h>
 
 #include <stdio.h>
@@ -43,6 +44,18 @@ Environment:
 
 #define DEFAULT_THREAD_COUNT 2
 
+//
+// Requests kept outstanding per direction by the throughput test. The
+// driver runs up to four transactions per DMA channel.
+//
+#define DEFAULT_QUEUE_DEPTH 4
+#define MAXIMUM_QUEUE_DEPTH 64
+
+//
+// Chunks in the ring used by the stream test; each is ReadBufferSize bytes.
+//
+#define DEFAULT_STREAM_CHUNKS 64
+
 typedef struct _THREAD_CONTEXT
 {
     HANDLE  hDevice;
@@ -65,6 +78,9 @@ typedef enum {
     DISPLAY_BUFFERS = 8,
     THREAD_TIME     = 9,
     COMMAND_LINE    = 10,
+    THROUGHPUT_TEST = 11,
+    QUEUE_DEPTH     = 12,
+    STREAM_TEST     = 13,
 
 } COMMAND;
 
@@ -114,6 +130,15 @@ public:
     void
     SetThreadLifeTime(ULONG time);
 
+    BOOL
+    ThroughputTest();
+
+    BOOL
+    SetQueueDepth(ULONG depth);
+
+    BOOL
+    StreamTest();
+
     BOOL  Quite;
     ULONG Status;
 
@@ -122,6 +147,9 @@ private:
     BOOL
     GetDeviceHandle();
 
+    BOOL
+    MeasureThroughput(HANDLE hOverlapped, BOOL read);
+
     HDEVINFO hDevInfo;
     PSP_DEVICE_INTERFACE_DETAIL_DATA pDeviceInterfaceDetail;
     HANDLE hDevice;
@@ -141,6 +169,8 @@ private:
 
     ULONG ThreadTimer;
 
+    ULONG QueueDepth;
+
     BOOL console;
 };
 
@@ -35,9 +35,24 @@ SetupDriverName(
     _In_ ULONG BufferLength
     );
 
+VOID
+StreamTest(
+    _In_ ULONG HalfLength,
+    _In_ ULONG PollInterval,
+    _In_ ULONG Seconds
+    );
+
 char OutputBuffer[100];
 char InputBuffer[100];
 
+//
+// Number of IOCTL_SDMA_READ_HALF requests kept pending during the stream
+// test. With more than one in flight the driver always has somewhere to
+// put a half even while the application is processing the previous one.
+//
+
+#define STREAM_READS_IN_FLIGHT 4
+
 VOID __cdecl
 main(
     _In_ ULONG argc,
@@ -50,9 +65,6 @@ main(
     DWORD errNum = 0;
     TCHAR driverLocation[MAX_PATH];
 
-    UNREFERENCED_PARAMETER(argc);
-    UNREFERENCED_PARAMETER(argv);
-
     //
     // open the device
     //
@@ -118,6 +130,20 @@ main(
 
     }
 
+    //
+    // "-stream [HalfKB] [PollUs] [Seconds]" runs the continuous capture
+    // test instead of the single write.
+    //
+
+    if (argc > 1 && _stricmp(argv[1], "-stream") == 0) {
+
+        StreamTest((argc > 2 ? strtoul(argv[2], NULL, 10) : 4) * 1024,
+                   argc > 3 ? strtoul(argv[3], NULL, 10) : 1000,
+                   argc > 4 ? strtoul(argv[4], NULL, 10) : 10);
+
+        goto Unload;
+    }
+
 #if 0
     //
     // Printing Input & Output buffer pointers and size
@@ -158,6 +184,7 @@ main(
     }
     printf("    OutBuffer (%d): %s\n", bytesReturned, OutputBuffer);
 
+Unload:
     CloseHandle ( hDevice );
 
     //
@@ -178,3 +205,214 @@ main(
 }
 
 
+
+BOOL
+StreamControl(
+    _In_ HANDLE hStream,
+    _In_ DWORD IoControlCode,
+    _In_reads_bytes_opt_(InputLength) PVOID InputBuffer,
+    _In_ DWORD InputLength
+    )
+/*++
+
+Routine Description:
+
+    Sends a start or stop request on the overlapped stream handle and
+    waits for it to complete.
+
+--*/
+{
+    OVERLAPPED overlapped;
+    DWORD bytesReturned;
+    BOOL bRc;
+
+    ZeroMemory(&overlapped, sizeof(overlapped));
+    overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (overlapped.hEvent == NULL) {
+        return FALSE;
+    }
+
+    bRc = DeviceIoControl(hStream, IoControlCode, InputBuffer, InputLength,
+                          NULL, 0, &bytesReturned, &overlapped);
+
+    if (!bRc && GetLastError() == ERROR_IO_PENDING) {
+        bRc = GetOverlappedResult(hStream, &overlapped, &bytesReturned, TRUE);
+    }
+
+    CloseHandle(overlapped.hEvent);
+    return bRc;
+}
+
+VOID
+StreamTest(
+    _In_ ULONG HalfLength,
+    _In_ ULONG PollInterval,
+    _In_ ULONG Seconds
+    )
+/*++
+
+Routine Description:
+
+    Starts a continuous capture, keeps STREAM_READS_IN_FLIGHT reads pending
+    for the given number of seconds and reports the sustained throughput
+    and any gaps in the stream.
+
+    A gap is a half the driver completed while no read was pending; such
+    halves show up as a jump in the sequence number and in the driver's
+    missed count. The interval between halves is taken from the driver's
+    timestamps, so it shows how evenly the poll DPC saw them complete.
+
+--*/
+{
+    HANDLE hStream;
+    SDMA_STREAM_CONFIG config;
+    PSDMA_HALF_HEADER header;
+    PUCHAR buffers[STREAM_READS_IN_FLIGHT] = { NULL };
+    OVERLAPPED overlapped[STREAM_READS_IN_FLIGHT];
+    DWORD readLength = sizeof(SDMA_HALF_HEADER) + HalfLength;
+    DWORD bytesReturned;
+    LARGE_INTEGER frequency, startTime, now;
+    LONGLONG lastTimestamp = 0, interval;
+    LONGLONG minInterval = MAXLONGLONG, maxInterval = 0;
+    ULONGLONG totalBytes = 0;
+    ULONG halves = 0, lastSequence = 0, gaps = 0, missed = 0;
+    ULONG next = 0, i;
+    BOOL streaming = FALSE;
+    double elapsed;
+
+    printf("\nStreaming 2 x %d bytes, polled every %d us, for %d seconds:\n",
+           HalfLength, PollInterval, Seconds);
+
+    ZeroMemory(overlapped, sizeof(overlapped));
+
+    //
+    // Reads are kept pending, so the stream needs its own overlapped handle.
+    //
+
+    hStream = CreateFile("\\\\.\\DmaTest",
+                         GENERIC_READ | GENERIC_WRITE,
+                         0,
+                         NULL,
+                         OPEN_EXISTING,
+                         FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED,
+                         NULL);
+
+    if (hStream == INVALID_HANDLE_VALUE) {
+        printf("Error: CreateFile for stream failed : %d\n", (int)GetLastError());
+        return;
+    }
+
+    for (i = 0; i < STREAM_READS_IN_FLIGHT; i++) {
+        buffers[i] = malloc(readLength);
+        overlapped[i].hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        if (buffers[i] == NULL || overlapped[i].hEvent == NULL) {
+            printf("Error: out of memory\n");
+            goto Exit;
+        }
+    }
+
+    config.HalfLength = HalfLength;
+    config.PollInterval = PollInterval;
+
+    if (!StreamControl(hStream, (DWORD) IOCTL_SDMA_START_STREAM,
+                       &config, sizeof(config))) {
+        printf("Error: IOCTL_SDMA_START_STREAM failed : %d\n", (int)GetLastError());
+        goto Exit;
+    }
+
+    streaming = TRUE;
+
+    for (i = 0; i < STREAM_READS_IN_FLIGHT; i++) {
+        if (!DeviceIoControl(hStream, (DWORD) IOCTL_SDMA_READ_HALF, NULL, 0,
+                             buffers[i], readLength, NULL, &overlapped[i]) &&
+            GetLastError() != ERROR_IO_PENDING) {
+            printf("Error: IOCTL_SDMA_READ_HALF failed : %d\n", (int)GetLastError());
+            goto Exit;
+        }
+    }
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&startTime);
+
+    //
+    // The driver completes reads in the order they were sent, so waiting
+    // on them round-robin sees every half in sequence.
+    //
+
+    for (;;) {
+
+        if (!GetOverlappedResult(hStream, &overlapped[next], &bytesReturned, TRUE)) {
+            printf("Error: IOCTL_SDMA_READ_HALF failed : %d\n", (int)GetLastError());
+            goto Exit;
+        }
+
+        header = (PSDMA_HALF_HEADER) buffers[next];
+
+        if (halves != 0) {
+            gaps += header->Sequence - lastSequence - 1;
+
+            interval = header->Timestamp - lastTimestamp;
+            minInterval = min(minInterval, interval);
+            maxInterval = max(maxInterval, interval);
+        }
+
+        halves++;
+        totalBytes += header->Length;
+        lastSequence = header->Sequence;
+        lastTimestamp = header->Timestamp;
+        missed = header->Missed;
+
+        QueryPerformanceCounter(&now);
+        if ((ULONGLONG)(now.QuadPart - startTime.QuadPart) >=
+            (ULONGLONG) frequency.QuadPart * Seconds) {
+            break;
+        }
+
+        if (!DeviceIoControl(hStream, (DWORD) IOCTL_SDMA_READ_HALF, NULL, 0,
+                             buffers[next], readLength, NULL, &overlapped[next]) &&
+            GetLastError() != ERROR_IO_PENDING) {
+            printf("Error: IOCTL_SDMA_READ_HALF failed : %d\n", (int)GetLastError());
+            goto Exit;
+        }
+
+        next = (next + 1) % STREAM_READS_IN_FLIGHT;
+    }
+
+    elapsed = (double)(now.QuadPart - startTime.QuadPart) / frequency.QuadPart;
+
+    printf("    Halves read        : %d\n", halves);
+    printf("    Bytes read         : %I64u\n", totalBytes);
+    printf("    Throughput         : %.1f KB/s\n", totalBytes / 1024.0 / elapsed);
+    printf("    Sequence gaps      : %d halves\n", gaps);
+    printf("    Missed by driver   : %d halves\n", missed);
+
+    if (halves > 1) {
+        printf("    Half interval      : min %.0f us, max %.0f us, avg %.0f us\n",
+               minInterval * 1000000.0 / frequency.QuadPart,
+               maxInterval * 1000000.0 / frequency.QuadPart,
+               elapsed * 1000000.0 / (halves - 1));
+    }
+
+Exit:
+
+    //
+    // Stopping the stream cancels the reads still pending; wait for them
+    // before their buffers and events are freed.
+    //
+
+    if (streaming) {
+        StreamControl(hStream, (DWORD) IOCTL_SDMA_STOP_STREAM, NULL, 0);
+    }
+
+    CancelIo(hStream);
+
+    for (i = 0; i < STREAM_READS_IN_FLIGHT; i++) {
+        if (overlapped[i].hEvent != NULL) {
+            GetOverlappedResult(hStream, &overlapped[i], &bytesReturned, TRUE);
+            CloseHandle(overlapped[i].hEvent);
+        }
+        free(buffers[i]);
+    }
+
+    CloseHandle(hStream);
+}
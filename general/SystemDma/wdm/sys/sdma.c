@@ -89,6 +89,66 @@ typedef struct _COMMON_DEVICE_DATA
 
 } COMMON_DEVICE_DATA, *PCOMMON_DEVICE_DATA;
 
+//
+// State of a continuous autoinitialize capture. The buffer is split into
+// two halves; the controller wraps around it until the stream is stopped,
+// and a timer DPC polls the DMA counter to see when a half has filled.
+// Lock protects everything except the pending read queue, which has its
+// own lock so that it can be taken with Lock held.
+//
+
+typedef struct _SDMA_STREAM
+{
+    KSPIN_LOCK      Lock;
+
+    BOOLEAN         Streaming;
+
+    BOOLEAN         ChannelAllocated;
+
+    BOOLEAN         TransferMapped;
+
+    // The handle that started the stream; only it may read or stop it
+
+    PFILE_OBJECT    Owner;
+
+    PDMA_ADAPTER    Adapter;
+
+    PVOID           MapRegisterBase;
+
+    CHAR            DmaTransferContext[ DMA_TRANSFER_CONTEXT_SIZE_V1 ];
+
+    // The two halves, back to back, and their system address
+
+    PMDL            Mdl;
+
+    PUCHAR          Buffer;
+
+    ULONG           HalfLength;
+
+    // The half the controller is filling as of the last poll
+
+    ULONG           ActiveHalf;
+
+    ULONG           Sequence;
+
+    ULONG           Missed;
+
+    LARGE_INTEGER   PollDueTime;
+
+    KTIMER          PollTimer;
+
+    KDPC            PollDpc;
+
+    // IOCTL_SDMA_READ_HALF requests waiting for the next half
+
+    IO_CSQ          ReadCsq;
+
+    LIST_ENTRY      PendingReads;
+
+    KSPIN_LOCK      PendingReadsLock;
+
+} SDMA_STREAM, *PSDMA_STREAM;
+
 //
 // The device extension of the bus itself.  From whence the PDO's are born.
 //
@@ -141,6 +201,8 @@ typedef struct _FDO_DEVICE_DATA
 
     UNICODE_STRING      InterfaceName;
 
+    SDMA_STREAM         Stream;
+
 } FDO_DEVICE_DATA, *PFDO_DEVICE_DATA;
 
 //
@@ -173,11 +235,29 @@ _Dispatch_type_(IRP_MJ_CREATE)
 _Dispatch_type_(IRP_MJ_CLOSE)
 DRIVER_DISPATCH SDmaCreateClose;
 
+_Dispatch_type_(IRP_MJ_CLEANUP)
+DRIVER_DISPATCH SDmaCleanup;
+
 _Dispatch_type_(IRP_MJ_DEVICE_CONTROL)
 DRIVER_DISPATCH SDmaDeviceControl;
 
 DRIVER_UNLOAD SDmaUnloadDriver;
 
+KDEFERRED_ROUTINE SDmaStreamPollDpc;
+
+IO_CSQ_INSERT_IRP SDmaCsqInsertIrp;
+IO_CSQ_REMOVE_IRP SDmaCsqRemoveIrp;
+IO_CSQ_PEEK_NEXT_IRP SDmaCsqPeekNextIrp;
+IO_CSQ_ACQUIRE_LOCK SDmaCsqAcquireLock;
+IO_CSQ_RELEASE_LOCK SDmaCsqReleaseLock;
+IO_CSQ_COMPLETE_CANCELED_IRP SDmaCsqCompleteCanceledIrp;
+
+NTSTATUS
+SDmaStopStream(
+    _In_     PFDO_DEVICE_DATA pFdoData,
+    _In_opt_ PFILE_OBJECT FileObject
+    );
+
 VOID
 PrintIrpInfo(
     PIRP Irp
@@ -191,6 +271,7 @@ PrintChars(
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text( INIT, DriverEntry )
 #pragma alloc_text( PAGE, SDmaCreateClose)
+#pragma alloc_text( PAGE, SDmaCleanup)
 #pragma alloc_text( PAGE, SDmaDeviceControl)
 #pragma alloc_text( PAGE, SDmaUnloadDriver)
 #pragma alloc_text( PAGE, PrintIrpInfo)
@@ -227,6 +308,7 @@ Return Value:
     UNICODE_STRING  ntUnicodeString;    // NT Device Name "\Device\SDMA"
     UNICODE_STRING  ntWin32NameString;    // Win32 Name "\DosDevices\DmaTest"
     PDEVICE_OBJECT  deviceObject = NULL;    // ptr to device object
+    PFDO_DEVICE_DATA fdoData;
 
     UNREFERENCED_PARAMETER(RegistryPath);
 
@@ -234,7 +316,7 @@ Return Value:
 
     ntStatus = IoCreateDevice(
         DriverObject,                   // Our Driver Object
-        0,                              // We don't use a device extension
+        sizeof(FDO_DEVICE_DATA),        // Stream state lives here
         &ntUnicodeString,               // Device name "\Device\SDMA"
         FILE_DEVICE_UNKNOWN,            // Device type
         FILE_DEVICE_SECURE_OPEN,     // Device characteristics
@@ -247,12 +329,33 @@ Return Value:
         return ntStatus;
     }
 
+    fdoData = (PFDO_DEVICE_DATA) deviceObject->DeviceExtension;
+    RtlZeroMemory(fdoData, sizeof(FDO_DEVICE_DATA));
+    fdoData->CommonData.Self = deviceObject;
+    fdoData->CommonData.IsFDO = TRUE;
+    ExInitializeFastMutex(&fdoData->Mutex);
+
+    KeInitializeSpinLock(&fdoData->Stream.Lock);
+    KeInitializeTimer(&fdoData->Stream.PollTimer);
+    KeInitializeDpc(&fdoData->Stream.PollDpc, SDmaStreamPollDpc, fdoData);
+    InitializeListHead(&fdoData->Stream.PendingReads);
+    KeInitializeSpinLock(&fdoData->Stream.PendingReadsLock);
+
+    IoCsqInitialize(&fdoData->Stream.ReadCsq,
+                    SDmaCsqInsertIrp,
+                    SDmaCsqRemoveIrp,
+                    SDmaCsqPeekNextIrp,
+                    SDmaCsqAcquireLock,
+                    SDmaCsqReleaseLock,
+                    SDmaCsqCompleteCanceledIrp);
+
     //
     // Initialize the driver object with this driver's entry points.
     //
 
     DriverObject->MajorFunction[IRP_MJ_CREATE] = SDmaCreateClose;
     DriverObject->MajorFunction[IRP_MJ_CLOSE] = SDmaCreateClose;
+    DriverObject->MajorFunction[IRP_MJ_CLEANUP] = SDmaCleanup;
     DriverObject->MajorFunction[IRP_MJ_DEVICE_CONTROL] = SDmaDeviceControl;
     DriverObject->DriverUnload = SDmaUnloadDriver;
 
@@ -324,6 +427,48 @@ Return Value:
     return STATUS_SUCCESS;
 }
 
+NTSTATUS
+SDmaCleanup(
+    PDEVICE_OBJECT DeviceObject,
+    PIRP Irp
+    )
+/*++
+
+Routine Description:
+
+    This routine is called by the I/O system when the last handle to a
+    file object is closed.
+
+    A stream left running by the application is stopped here, which also
+    fails any reads that are still pending.
+
+Arguments:
+
+    DeviceObject - a pointer to the object that represents the device
+    that I/O is to be done on.
+
+    Irp - a pointer to the I/O Request Packet for this request.
+
+Return Value:
+
+    NT status code
+
+--*/
+
+{
+    PAGED_CODE();
+
+    SDmaStopStream( (PFDO_DEVICE_DATA) DeviceObject->DeviceExtension,
+                    IoGetCurrentIrpStackLocation( Irp )->FileObject );
+
+    Irp->IoStatus.Status = STATUS_SUCCESS;
+    Irp->IoStatus.Information = 0;
+
+    IoCompleteRequest( Irp, IO_NO_INCREMENT );
+
+    return STATUS_SUCCESS;
+}
+
 VOID
 SDmaUnloadDriver(
     _In_ PDRIVER_OBJECT DriverObject
@@ -366,6 +511,7 @@ Return Value:
 
     if ( deviceObject != NULL )
     {
+        SDmaStopStream( (PFDO_DEVICE_DATA) deviceObject->DeviceExtension, NULL );
         IoDeleteDevice( deviceObject );
     }
 
@@ -1161,6 +1307,708 @@ Exit:
     return Status;
 }
 
+//
+// These routines run the continuous capture. The cancel-safe queue
+// callbacks hold IOCTL_SDMA_READ_HALF requests until a half is ready.
+//
+
+VOID
+SDmaCsqInsertIrp(
+    _In_ PIO_CSQ   Csq,
+    _In_ PIRP      Irp
+    )
+{
+    PSDMA_STREAM stream;
+
+    stream = CONTAINING_RECORD(Csq, SDMA_STREAM, ReadCsq);
+
+    InsertTailList(&stream->PendingReads, &Irp->Tail.Overlay.ListEntry);
+}
+
+VOID
+SDmaCsqRemoveIrp(
+    _In_  PIO_CSQ Csq,
+    _In_  PIRP    Irp
+    )
+{
+    UNREFERENCED_PARAMETER(Csq);
+
+    RemoveEntryList(&Irp->Tail.Overlay.ListEntry);
+}
+
+PIRP
+SDmaCsqPeekNextIrp(
+    _In_  PIO_CSQ Csq,
+    _In_  PIRP    Irp,
+    _In_  PVOID   PeekContext
+    )
+{
+    PSDMA_STREAM stream;
+    PLIST_ENTRY  nextEntry;
+
+    UNREFERENCED_PARAMETER(PeekContext);
+
+    stream = CONTAINING_RECORD(Csq, SDMA_STREAM, ReadCsq);
+
+    //
+    // Reads are only queued by the stream owner, so there is never a
+    // peek context to match; hand out the IRPs in arrival order.
+    //
+
+    if (Irp == NULL)
+    {
+        nextEntry = stream->PendingReads.Flink;
+    }
+    else
+    {
+        nextEntry = Irp->Tail.Overlay.ListEntry.Flink;
+    }
+
+    if (nextEntry == &stream->PendingReads)
+    {
+        return NULL;
+    }
+
+    return CONTAINING_RECORD(nextEntry, IRP, Tail.Overlay.ListEntry);
+}
+
+_IRQL_raises_(DISPATCH_LEVEL)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_Acquires_lock_(CONTAINING_RECORD(Csq, SDMA_STREAM, ReadCsq)->PendingReadsLock)
+VOID
+SDmaCsqAcquireLock(
+    _In_                                    PIO_CSQ Csq,
+    _Out_ _At_(*Irql, _Post_ _IRQL_saves_)  PKIRQL  Irql
+    )
+{
+    PSDMA_STREAM stream;
+
+    stream = CONTAINING_RECORD(Csq, SDMA_STREAM, ReadCsq);
+
+#pragma prefast(suppress: __WARNING_BUFFER_UNDERFLOW, "Underflow using expression 'stream->PendingReadsLock'")
+    KeAcquireSpinLock(&stream->PendingReadsLock, Irql);
+}
+
+_IRQL_requires_(DISPATCH_LEVEL)
+_Releases_lock_(CONTAINING_RECORD(Csq, SDMA_STREAM, ReadCsq)->PendingReadsLock)
+VOID
+SDmaCsqReleaseLock(
+    _In_                    PIO_CSQ Csq,
+    _In_ _IRQL_restores_    KIRQL   Irql
+    )
+{
+    PSDMA_STREAM stream;
+
+    stream = CONTAINING_RECORD(Csq, SDMA_STREAM, ReadCsq);
+
+#pragma prefast(suppress: __WARNING_BUFFER_UNDERFLOW, "Underflow using expression 'stream->PendingReadsLock'")
+    KeReleaseSpinLock(&stream->PendingReadsLock, Irql);
+}
+
+VOID
+SDmaCsqCompleteCanceledIrp(
+    _In_  PIO_CSQ             Csq,
+    _In_  PIRP                Irp
+    )
+{
+    UNREFERENCED_PARAMETER(Csq);
+
+    Irp->IoStatus.Status = STATUS_CANCELLED;
+    Irp->IoStatus.Information = 0;
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+}
+
+VOID
+SDmaTeardownStream(
+    _In_ PSDMA_STREAM Stream
+    )
+
+/*++
+
+Routine Description:
+
+    This function stops the poll timer, fails the pending reads and
+    releases whatever part of the stream has been set up so far, so it
+    serves both SDmaStopStream and a failed SDmaStartStream.
+
+    The caller holds the device mutex.
+
+Arguments:
+
+    Stream - Supplies the stream to tear down.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    KIRQL Irql;
+    PIRP  Irp;
+
+    ASSERT(KeGetCurrentIrql() == PASSIVE_LEVEL);
+
+    //
+    // Once Streaming is clear the DPC no longer re-arms the timer and no
+    // new reads are queued, so after the flush nothing but this thread
+    // touches the stream.
+    //
+
+    KeAcquireSpinLock(&Stream->Lock, &Irql);
+    Stream->Streaming = FALSE;
+    KeReleaseSpinLock(&Stream->Lock, Irql);
+
+    KeCancelTimer(&Stream->PollTimer);
+    KeFlushQueuedDpcs();
+
+    while ((Irp = IoCsqRemoveNextIrp(&Stream->ReadCsq, NULL)) != NULL)
+    {
+        Irp->IoStatus.Status = STATUS_CANCELLED;
+        Irp->IoStatus.Information = 0;
+        IoCompleteRequest(Irp, IO_NO_INCREMENT);
+    }
+
+    //
+    // For system DMA, flushing the adapter buffers is what halts the
+    // controller on an autoinitialize transfer.
+    //
+
+    if (Stream->TransferMapped)
+    {
+        Stream->Adapter->DmaOperations->FlushAdapterBuffersEx(
+            Stream->Adapter,
+            Stream->Mdl,
+            Stream->MapRegisterBase,
+            0,
+            Stream->HalfLength * 2,
+            FALSE);
+
+        Stream->TransferMapped = FALSE;
+    }
+
+    if (Stream->ChannelAllocated)
+    {
+        KeRaiseIrql(DISPATCH_LEVEL, &Irql);
+        Stream->Adapter->DmaOperations->FreeAdapterChannel( Stream->Adapter );
+        KeLowerIrql(Irql);
+
+        Stream->ChannelAllocated = FALSE;
+        Stream->MapRegisterBase = NULL;
+    }
+
+    if (Stream->Mdl != NULL)
+    {
+        SDmaFreeMdl(Stream->Mdl);
+        Stream->Mdl = NULL;
+        Stream->Buffer = NULL;
+    }
+
+    if (Stream->Adapter != NULL)
+    {
+        Stream->Adapter->DmaOperations->PutDmaAdapter(Stream->Adapter);
+        Stream->Adapter = NULL;
+    }
+
+    Stream->Owner = NULL;
+}
+
+NTSTATUS
+SDmaStartStream(
+    _In_ PFDO_DEVICE_DATA    pFdoData,
+    _In_ PFILE_OBJECT        FileObject,
+    _In_ PSDMA_STREAM_CONFIG Config
+    )
+
+/*++
+
+Routine Description:
+
+    This function starts a continuous capture from the device into a
+    two-half buffer. The whole buffer is handed to the controller as one
+    autoinitialize transfer, so the controller reloads its address and
+    count at the end of the buffer and keeps going without the driver
+    having to program the next transfer in time.
+
+    System DMA controllers do not interrupt at the half-way point, so a
+    timer DPC polls the DMA counter every Config->PollInterval and treats
+    the counter crossing into the other half as the half-complete event.
+    The interval must be well below the time it takes to fill one half.
+
+    As with SDmaWrite, no system DMA controller supports the request line
+    used here, so on real systems this fails to acquire an adapter.
+
+Arguments:
+
+    pFdoData - Supplies the FDO extension
+
+    FileObject - Supplies the handle that is starting the stream.
+
+    Config - Supplies the half length and poll interval.
+
+Return Value:
+
+    This function returns a NTSTATUS value.
+
+--*/
+
+{
+    KIRQL Irql;
+    ULONG DmaRequestLine = 0x1000;
+    NTSTATUS Status;
+    PSDMA_STREAM Stream = &pFdoData->Stream;
+    ULONG AllocatableMapRegisters = 0;
+    ULONG BufferLength;
+    ULONG Length;
+    DEVICE_DESCRIPTION Description;
+    SDMA_CALLBACK_CONTEXT StreamContext;
+    PHYSICAL_ADDRESS LowAddress;
+    PHYSICAL_ADDRESS HighAddress;
+    PHYSICAL_ADDRESS SkipAddress;
+
+    ASSERT(KeGetCurrentIrql() == PASSIVE_LEVEL);
+
+    if (Config->HalfLength == 0 ||
+        Config->HalfLength > SDMA_STREAM_MAXIMUM_HALF_LENGTH ||
+        (Config->HalfLength % sizeof(ULONG)) != 0 ||
+        Config->PollInterval == 0)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    BufferLength = Config->HalfLength * 2;
+
+    //
+    // The fast mutex is acquired unsafe inside a critical region so that
+    // IoGetDmaAdapter and the waits below still run at PASSIVE_LEVEL.
+    //
+
+    KeEnterCriticalRegion();
+    ExAcquireFastMutexUnsafe(&pFdoData->Mutex);
+
+    if (Stream->Owner != NULL)
+    {
+        Status = STATUS_DEVICE_BUSY;
+        goto Exit;
+    }
+
+    RtlZeroMemory(&Description, sizeof(Description));
+    Description.Version           = DEVICE_DESCRIPTION_VERSION3;
+    Description.DmaAddressWidth   = 32;
+    Description.DmaRequestLine    = DmaRequestLine;
+    Description.DmaChannel        = DmaRequestLine;
+    Description.DmaWidth          = Width32Bits;
+    Description.InterfaceType     = ACPIBus;
+    Description.Master            = FALSE;
+    Description.ScatterGather     = TRUE;
+    Description.AutoInitialize    = TRUE;
+    Description.MaximumLength     = BufferLength;
+
+    Stream->Adapter = IoGetDmaAdapter(pFdoData->UnderlyingPDO,
+                                      &Description,
+                                      &AllocatableMapRegisters);
+
+    if (Stream->Adapter == NULL)
+    {
+        DbgPrintEx(DPFLTR_IHVBUS_ID, 0, "IoGetDmaAdapter failed for request line %d. \n", Description.DmaRequestLine );
+        Status = STATUS_NO_MATCH;
+        goto Exit;
+    }
+
+    if (AllocatableMapRegisters < BYTES_TO_PAGES(BufferLength))
+    {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Exit;
+    }
+
+    //
+    // Both halves come from one physically contiguous allocation, so the
+    // single transfer below needs as few map registers as possible.
+    //
+
+    LowAddress.QuadPart = 0;
+    HighAddress.QuadPart = 0xffffffffffffffffI64;
+    SkipAddress.QuadPart = 0;
+
+    Stream->Mdl = MmAllocatePagesForMdlEx(LowAddress,
+                                          HighAddress,
+                                          SkipAddress,
+                                          BufferLength,
+                                          MmCached,
+                                          MM_ALLOCATE_REQUIRE_CONTIGUOUS_CHUNKS
+                                          );
+
+    if (Stream->Mdl == NULL || MmGetMdlByteCount(Stream->Mdl) < BufferLength)
+    {
+        DbgPrintEx(DPFLTR_IHVBUS_ID, 0, "MmAllocatePagesForMdlEx failed. \n" );
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Exit;
+    }
+
+    Stream->Buffer = MmMapLockedPagesSpecifyCache(Stream->Mdl,
+                                                  KernelMode,
+                                                  MmCached,
+                                                  NULL,
+                                                  FALSE,
+                                                  HighPagePriority);
+
+    if (Stream->Buffer == NULL)
+    {
+        DbgPrintEx(DPFLTR_IHVBUS_ID, 0, "MmMapLockedPagesSpecifyCache failed. \n" );
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Exit;
+    }
+
+    RtlZeroMemory(Stream->Buffer, BufferLength);
+
+    Stream->Adapter->DmaOperations->InitializeDmaTransferContext(
+        Stream->Adapter,
+        (PVOID)&(Stream->DmaTransferContext));
+
+    RtlZeroMemory( &StreamContext, sizeof( StreamContext ) );
+    StreamContext.Action = KeepObject;
+    StreamContext.NumberOfMapRegisters = AllocatableMapRegisters;
+    KeInitializeEvent(&(StreamContext.CallBackEvent), NotificationEvent, FALSE);
+    KeInitializeEvent(&(StreamContext.CompletionEvent), NotificationEvent, FALSE);
+
+    KeRaiseIrql(DISPATCH_LEVEL, &Irql);
+
+    Status = Stream->Adapter->DmaOperations->AllocateAdapterChannelEx(
+        Stream->Adapter,
+        pFdoData->CommonData.Self,
+        &(Stream->DmaTransferContext),
+        AllocatableMapRegisters,
+        0,
+        SDmaAdapterControl,
+        (PVOID) &StreamContext,
+        NULL);
+    KeLowerIrql(Irql);
+
+    if (Status != STATUS_SUCCESS)
+    {
+        goto Exit;
+    }
+
+    KeWaitForSingleObject(&(StreamContext.CallBackEvent), Executive, KernelMode, FALSE, NULL);
+
+    Stream->ChannelAllocated = TRUE;
+    Stream->MapRegisterBase = StreamContext.MapRegisterBase;
+
+    Stream->HalfLength = Config->HalfLength;
+    Stream->ActiveHalf = 0;
+    Stream->Sequence = 0;
+    Stream->Missed = 0;
+    Stream->PollDueTime.QuadPart = -10 * (LONGLONG) Config->PollInterval;
+
+    //
+    // Read from the device (e.g. a UART Rx register or an ADC FIFO) into
+    // the whole buffer. An autoinitialize transfer never completes, so
+    // there is no completion routine; it runs until it is flushed.
+    //
+
+    Length = BufferLength;
+
+    Status = Stream->Adapter->DmaOperations->MapTransferEx(
+        Stream->Adapter,
+        Stream->Mdl,
+        Stream->MapRegisterBase,
+        0,
+        0x70006204, // Physical address of hardware
+                    // device
+                    // (e.g. UART Rx register)
+        &Length,
+        FALSE,
+        NULL,
+        0,
+        NULL,
+        NULL);
+
+    if (!NT_SUCCESS(Status))
+    {
+        goto Exit;
+    }
+
+    Stream->TransferMapped = TRUE;
+
+    //
+    // The controller has to wrap at the end of the buffer, which only
+    // works if the one transfer covers all of it.
+    //
+
+    if (Length != BufferLength)
+    {
+        DbgPrintEx(DPFLTR_IHVBUS_ID, 0, "MapTransferEx mapped %d of %d bytes. \n", Length, BufferLength );
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Exit;
+    }
+
+    KeAcquireSpinLock(&Stream->Lock, &Irql);
+    Stream->Owner = FileObject;
+    Stream->Streaming = TRUE;
+    KeSetTimer(&Stream->PollTimer, Stream->PollDueTime, &Stream->PollDpc);
+    KeReleaseSpinLock(&Stream->Lock, Irql);
+
+    DbgPrintEx(DPFLTR_IHVBUS_ID, 0,
+        "%p Stream started: 2 x %d bytes, polled every %d us\n",
+        Stream->Adapter, Stream->HalfLength, Config->PollInterval
+        );
+
+Exit:
+
+    if (!NT_SUCCESS(Status) && Stream->Owner == NULL)
+    {
+        SDmaTeardownStream(Stream);
+    }
+
+    ExReleaseFastMutexUnsafe(&pFdoData->Mutex);
+    KeLeaveCriticalRegion();
+
+    return Status;
+}
+
+NTSTATUS
+SDmaStopStream(
+    _In_     PFDO_DEVICE_DATA pFdoData,
+    _In_opt_ PFILE_OBJECT FileObject
+    )
+
+/*++
+
+Routine Description:
+
+    This function stops the stream and fails any reads still pending.
+
+Arguments:
+
+    pFdoData - Supplies the FDO extension
+
+    FileObject - Supplies the handle asking for the stop. The stream is
+        only stopped if this handle started it. NULL stops any stream.
+
+Return Value:
+
+    STATUS_INVALID_DEVICE_STATE if no stream was stopped.
+
+--*/
+
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    PSDMA_STREAM Stream = &pFdoData->Stream;
+
+    KeEnterCriticalRegion();
+    ExAcquireFastMutexUnsafe(&pFdoData->Mutex);
+
+    if (Stream->Owner == NULL ||
+        (FileObject != NULL && FileObject != Stream->Owner))
+    {
+        Status = STATUS_INVALID_DEVICE_STATE;
+    }
+    else
+    {
+        SDmaTeardownStream(Stream);
+    }
+
+    ExReleaseFastMutexUnsafe(&pFdoData->Mutex);
+    KeLeaveCriticalRegion();
+
+    return Status;
+}
+
+NTSTATUS
+SDmaQueueRead(
+    _In_ PFDO_DEVICE_DATA pFdoData,
+    _In_ PIRP Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This function pends an IOCTL_SDMA_READ_HALF request until the stream
+    poll DPC sees the next half complete.
+
+Arguments:
+
+    pFdoData - Supplies the FDO extension
+
+    Irp - Supplies the read request.
+
+Return Value:
+
+    STATUS_PENDING if the request was queued; otherwise the caller
+    completes it with the returned status.
+
+--*/
+
+{
+    KIRQL Irql;
+    NTSTATUS Status;
+    PIO_STACK_LOCATION irpSp;
+    PSDMA_STREAM Stream = &pFdoData->Stream;
+
+    irpSp = IoGetCurrentIrpStackLocation( Irp );
+
+    if (irpSp->Parameters.DeviceIoControl.OutputBufferLength <
+        sizeof(SDMA_HALF_HEADER))
+    {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    //
+    // Queueing under the stream lock means a concurrent stop either sees
+    // this request when it drains the queue or this request sees the
+    // stream already stopped.
+    //
+
+    KeAcquireSpinLock(&Stream->Lock, &Irql);
+
+    if (!Stream->Streaming || Stream->Owner != irpSp->FileObject)
+    {
+        Status = STATUS_INVALID_DEVICE_STATE;
+    }
+    else
+    {
+        //
+        // Note: IoCsqInsertIrp marks the IRP pending.
+        //
+
+        IoCsqInsertIrp(&Stream->ReadCsq, Irp, NULL);
+        Status = STATUS_PENDING;
+    }
+
+    KeReleaseSpinLock(&Stream->Lock, Irql);
+
+    return Status;
+}
+
+_Use_decl_annotations_
+VOID
+SDmaStreamPollDpc(
+    PKDPC Dpc,
+    PVOID DeferredContext,
+    PVOID SystemArgument1,
+    PVOID SystemArgument2
+    )
+
+/*++
+
+Routine Description:
+
+    This is the poll timer DPC. It reads the DMA counter, and when the
+    controller has moved on to the other half it hands the half just
+    filled to the oldest pending read, or counts it as missed if there
+    is none.
+
+Arguments:
+
+    DeferredContext - Supplies the FDO extension.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    DISPATCH_LEVEL.
+
+--*/
+
+{
+    PFDO_DEVICE_DATA pFdoData = (PFDO_DEVICE_DATA) DeferredContext;
+    PSDMA_STREAM Stream = &pFdoData->Stream;
+    PIRP Irp = NULL;
+    PIO_STACK_LOCATION irpSp;
+    SDMA_HALF_HEADER Header = { 0 };
+    ULONG BufferLength;
+    ULONG Position;
+    ULONG Half;
+    PUCHAR OutBuf;
+
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    KeAcquireSpinLockAtDpcLevel(&Stream->Lock);
+
+    if (!Stream->Streaming)
+    {
+        KeReleaseSpinLockFromDpcLevel(&Stream->Lock);
+        return;
+    }
+
+    //
+    // ReadDmaCounter returns the bytes left before the controller reloads,
+    // so a count of zero means it is about to start on half 0 again.
+    //
+
+    BufferLength = Stream->HalfLength * 2;
+    Position = BufferLength - Minimum(
+        Stream->Adapter->DmaOperations->ReadDmaCounter(Stream->Adapter),
+        BufferLength);
+
+    Half = (Position >= Stream->HalfLength && Position < BufferLength) ? 1 : 0;
+
+    if (Half != Stream->ActiveHalf)
+    {
+        Header.Half = Stream->ActiveHalf;
+        Header.Sequence = ++Stream->Sequence;
+        Header.Timestamp = KeQueryPerformanceCounter(NULL).QuadPart;
+        Stream->ActiveHalf = Half;
+
+        Irp = IoCsqRemoveNextIrp(&Stream->ReadCsq, NULL);
+
+        if (Irp == NULL)
+        {
+            Stream->Missed++;
+        }
+
+        Header.Missed = Stream->Missed;
+    }
+
+    KeSetTimer(&Stream->PollTimer, Stream->PollDueTime, &Stream->PollDpc);
+
+    KeReleaseSpinLockFromDpcLevel(&Stream->Lock);
+
+    if (Irp == NULL)
+    {
+        return;
+    }
+
+    //
+    // The buffer is only freed after the teardown has flushed this DPC,
+    // so it can be copied from without the lock. The controller is now
+    // filling the other half, leaving one half time to finish the copy.
+    //
+
+    irpSp = IoGetCurrentIrpStackLocation( Irp );
+    Header.Length = Minimum(irpSp->Parameters.DeviceIoControl.OutputBufferLength
+                                - sizeof(SDMA_HALF_HEADER),
+                            Stream->HalfLength);
+
+    OutBuf = MmGetSystemAddressForMdlSafe(Irp->MdlAddress,
+                                          NormalPagePriority | MdlMappingNoExecute);
+
+    if (OutBuf == NULL)
+    {
+        Irp->IoStatus.Status = STATUS_INSUFFICIENT_RESOURCES;
+        Irp->IoStatus.Information = 0;
+    }
+    else
+    {
+        KeFlushIoBuffers(Stream->Mdl, TRUE, TRUE);
+
+        RtlCopyMemory(OutBuf, &Header, sizeof(Header));
+        RtlCopyMemory(OutBuf + sizeof(Header),
+                      Stream->Buffer + Header.Half * Stream->HalfLength,
+                      Header.Length);
+
+        Irp->IoStatus.Status = STATUS_SUCCESS;
+        Irp->IoStatus.Information = sizeof(Header) + Header.Length;
+    }
+
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+}
+
 NTSTATUS
 SDmaDeviceControl(
     PDEVICE_OBJECT DeviceObject,
@@ -1204,12 +2052,6 @@ Return Value:
     inBufLength = irpSp->Parameters.DeviceIoControl.InputBufferLength;
     outBufLength = irpSp->Parameters.DeviceIoControl.OutputBufferLength;
 
-    if (!inBufLength || !outBufLength)
-    {
-        ntStatus = STATUS_INVALID_PARAMETER;
-        goto End;
-    }
-
     //
     // Determine which I/O control code was specified.
     //
@@ -1218,6 +2060,12 @@ Return Value:
     {
     case IOCTL_SDMA_WRITE:
 
+        if (!inBufLength || !outBufLength)
+        {
+            ntStatus = STATUS_INVALID_PARAMETER;
+            break;
+        }
+
         //
         // In this method the I/O manager allocates a buffer large enough to
         // to accommodate larger of the user input buffer and output buffer,
@@ -1284,6 +2132,43 @@ Return Value:
 
        break;
 
+    case IOCTL_SDMA_START_STREAM:
+
+        SDMA_KDPRINT(("Called IOCTL_SDMA_START_STREAM\n"));
+
+        if (inBufLength < sizeof(SDMA_STREAM_CONFIG))
+        {
+            ntStatus = STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        ntStatus = SDmaStartStream( fdoData,
+                                    irpSp->FileObject,
+                                    (PSDMA_STREAM_CONFIG) Irp->AssociatedIrp.SystemBuffer );
+        break;
+
+    case IOCTL_SDMA_READ_HALF:
+
+        //
+        // The request is completed by the stream poll DPC, or by the
+        // stop, so it must not be touched once it has been queued.
+        //
+
+        ntStatus = SDmaQueueRead( fdoData, Irp );
+
+        if (ntStatus == STATUS_PENDING)
+        {
+            return ntStatus;
+        }
+        break;
+
+    case IOCTL_SDMA_STOP_STREAM:
+
+        SDMA_KDPRINT(("Called IOCTL_SDMA_STOP_STREAM\n"));
+
+        ntStatus = SDmaStopStream( fdoData, irpSp->FileObject );
+        break;
+
     default:
 
         //
@@ -1296,7 +2181,6 @@ Return Value:
         break;
     }
 
-End:
     //
     // Finish the I/O operation by simply completing the packet and returning
     // the same status as in the packet itself.
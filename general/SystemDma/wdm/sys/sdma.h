@@ -31,6 +31,40 @@ Environment:
 #define IOCTL_SDMA_WRITE \
     CTL_CODE( SDMA_TYPE, 0x902, METHOD_BUFFERED, FILE_ANY_ACCESS  )
 
+//
+// Continuous capture from the device into a two-half (ping-pong) buffer
+// using an autoinitialize system DMA transfer.
+//
+// IOCTL_SDMA_START_STREAM takes an SDMA_STREAM_CONFIG.
+// IOCTL_SDMA_READ_HALF pends until the controller has filled the next half
+// and returns an SDMA_HALF_HEADER followed by the data of that half.
+// IOCTL_SDMA_STOP_STREAM stops the transfer and fails pending reads.
+//
+
+#define IOCTL_SDMA_START_STREAM \
+    CTL_CODE( SDMA_TYPE, 0x903, METHOD_BUFFERED, FILE_ANY_ACCESS  )
+
+#define IOCTL_SDMA_READ_HALF \
+    CTL_CODE( SDMA_TYPE, 0x904, METHOD_OUT_DIRECT, FILE_ANY_ACCESS  )
+
+#define IOCTL_SDMA_STOP_STREAM \
+    CTL_CODE( SDMA_TYPE, 0x905, METHOD_BUFFERED, FILE_ANY_ACCESS  )
+
+#define SDMA_STREAM_MAXIMUM_HALF_LENGTH (64 * 1024)
+
+typedef struct _SDMA_STREAM_CONFIG {
+    ULONG HalfLength;       // bytes in each half, a multiple of 4
+    ULONG PollInterval;     // microseconds between DMA counter polls
+} SDMA_STREAM_CONFIG, *PSDMA_STREAM_CONFIG;
+
+typedef struct _SDMA_HALF_HEADER {
+    ULONG     Sequence;     // halves completed since the stream started
+    ULONG     Half;         // 0 or 1
+    ULONG     Length;       // bytes of data following this header
+    ULONG     Missed;       // halves completed with no read pending so far
+    LONGLONG  Timestamp;    // KeQueryPerformanceCounter when it was seen
+} SDMA_HALF_HEADER, *PSDMA_HALF_HEADER;
+
 #define DRIVER_FUNC_INSTALL     0x01
 #define DRIVER_FUNC_REMOVE      0x02
 
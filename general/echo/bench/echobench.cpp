@@ -0,0 +1,638 @@
+/*++
+
+Copyright (c) Microsoft Corporation
+
+Module Name:
+
+    EchoBench.cpp
+
+Abstract:
+
+    A benchmark for the WDF "echo" sample drivers. All versions of the
+    driver (KMDF AutoSync, DriverSync and ParallelQueue, UMDF, UMDF2 and
+    the UMDF socket echo) expose the same device interface, so the same
+    loop of overlapped writes and reads can be pointed at any of them to
+    compare the cost of dispatching requests through each framework and
+    synchronization scope.
+
+    Each thread opens its own handle, keeps a fixed number of requests
+    outstanding through an I/O completion port, and re-issues every
+    request as soon as it completes, alternating writes and reads. The
+    latency of each request is measured from issue to completion.
+
+
+Environment:
+
+    user mode only
+
+--*/
+
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_code_)
+
+#define INITGUID
+
+#include <windows.h>
+#include <strsafe.h>
+#include <cfgmgr32.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "public.h"
+
+#define DEFAULT_REQUEST_SIZE    512
+#define DEFAULT_QUEUE_DEPTH     1
+#define DEFAULT_THREAD_COUNT    1
+#define DEFAULT_SECONDS         10
+
+#define MAX_THREAD_COUNT        64
+#define MAX_QUEUE_DEPTH         1024
+
+#define MAX_DEVPATH_LENGTH                       256
+
+//
+// One outstanding request. Slots alternate between writing and reading
+// the same buffer, so the driver always sees as many reads as writes.
+//
+typedef struct _BENCH_SLOT {
+    OVERLAPPED      Overlapped;
+    PUCHAR          Buffer;
+    BOOLEAN         IsWrite;
+    LARGE_INTEGER   IssueTime;
+} BENCH_SLOT, *PBENCH_SLOT;
+
+//
+// Latencies of the completed requests of one kind, in performance
+// counter ticks.
+//
+typedef struct _BENCH_SAMPLES {
+    PLONGLONG   Latency;
+    ULONG       Count;
+    ULONG       Capacity;
+} BENCH_SAMPLES, *PBENCH_SAMPLES;
+
+typedef struct _BENCH_THREAD {
+    HANDLE          Thread;
+    HANDLE          hDevice;
+    HANDLE          Port;
+    BENCH_SLOT      Slots[MAX_QUEUE_DEPTH];
+    ULONG           Outstanding;
+    BENCH_SAMPLES   Reads;
+    BENCH_SAMPLES   Writes;
+    ULONG           Errors;
+    DWORD           FirstError;
+} BENCH_THREAD, *PBENCH_THREAD;
+
+ULONG G_RequestSize = DEFAULT_REQUEST_SIZE;
+ULONG G_QueueDepth = DEFAULT_QUEUE_DEPTH;
+ULONG G_ThreadCount = DEFAULT_THREAD_COUNT;
+ULONG G_Seconds = DEFAULT_SECONDS;
+ULONG G_DeviceIndex;
+BOOLEAN G_ListDevices;
+WCHAR G_DevicePath[MAX_DEVPATH_LENGTH];
+
+LARGE_INTEGER G_Frequency;
+LARGE_INTEGER G_StopTime;
+HANDLE G_StartEvent;
+
+
+ULONG
+BenchThread(
+    PVOID   ThreadParameter
+    );
+
+VOID
+PrintResults(
+    _In_reads_(ThreadCount) PBENCH_THREAD Threads,
+    _In_ ULONG ThreadCount,
+    _In_ LONGLONG ElapsedTicks
+    );
+
+BOOL
+GetDevicePath(
+    IN  LPGUID InterfaceGuid,
+    IN  ULONG Index,
+    IN  BOOLEAN List,
+    _Out_writes_(BufLen) PWCHAR DevicePath,
+    _In_ size_t BufLen
+    );
+
+
+int __cdecl
+main(
+    _In_ int argc,
+    _In_reads_(argc) char* argv[]
+    )
+{
+    PBENCH_THREAD threads = NULL;
+    LARGE_INTEGER startTime;
+    BOOLEAN result = TRUE;
+    ULONG created = 0;
+    ULONG i;
+    int arg;
+
+    for (arg = 1; arg < argc; arg++) {
+        if (!_stricmp(argv[arg], "-List")) {
+            G_ListDevices = TRUE;
+        } else if (arg + 1 < argc && !_stricmp(argv[arg], "-Size")) {
+            G_RequestSize = strtoul(argv[++arg], NULL, 0);
+        } else if (arg + 1 < argc && !_stricmp(argv[arg], "-Depth")) {
+            G_QueueDepth = strtoul(argv[++arg], NULL, 0);
+        } else if (arg + 1 < argc && !_stricmp(argv[arg], "-Threads")) {
+            G_ThreadCount = strtoul(argv[++arg], NULL, 0);
+        } else if (arg + 1 < argc && !_stricmp(argv[arg], "-Seconds")) {
+            G_Seconds = strtoul(argv[++arg], NULL, 0);
+        } else if (arg + 1 < argc && !_stricmp(argv[arg], "-Device")) {
+            G_DeviceIndex = strtoul(argv[++arg], NULL, 0);
+        } else {
+            break;
+        }
+    }
+
+    if (arg < argc ||
+        G_RequestSize == 0 ||
+        G_QueueDepth == 0 || G_QueueDepth > MAX_QUEUE_DEPTH ||
+        G_ThreadCount == 0 || G_ThreadCount > MAX_THREAD_COUNT ||
+        G_Seconds == 0) {
+        printf("Usage:\n");
+        printf("    EchoBench.exe [-Size <bytes>] [-Depth <n>] [-Threads <n>] [-Seconds <n>] [-Device <n>]\n");
+        printf("        -Size     bytes per read and write (default %d)\n", DEFAULT_REQUEST_SIZE);
+        printf("        -Depth    requests outstanding per thread, up to %d (default %d)\n",
+               MAX_QUEUE_DEPTH, DEFAULT_QUEUE_DEPTH);
+        printf("        -Threads  threads, each with its own handle, up to %d (default %d)\n",
+               MAX_THREAD_COUNT, DEFAULT_THREAD_COUNT);
+        printf("        -Seconds  length of the run (default %d)\n", DEFAULT_SECONDS);
+        printf("        -Device   which echo device interface to use (default 0)\n");
+        printf("    EchoBench.exe -List --- List the echo device interfaces\n");
+        result = FALSE;
+        goto exit;
+    }
+
+    if ( !GetDevicePath(
+            (LPGUID) &GUID_DEVINTERFACE_ECHO,
+            G_DeviceIndex,
+            G_ListDevices,
+            G_DevicePath,
+            sizeof(G_DevicePath)/sizeof(G_DevicePath[0])) )
+    {
+        result = FALSE;
+        goto exit;
+    }
+
+    if (G_ListDevices) {
+        goto exit;
+    }
+
+    printf("DevicePath: %ws\n", G_DevicePath);
+    printf("%d threads x %d outstanding, %d byte requests, %d seconds\n",
+           G_ThreadCount, G_QueueDepth, G_RequestSize, G_Seconds);
+
+    QueryPerformanceFrequency(&G_Frequency);
+
+    //
+    // The threads set up their handles and buffers first and then wait
+    // here, so that the measured interval only covers the I/O.
+    //
+    G_StartEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (G_StartEvent == NULL) {
+        printf("CreateEvent failed - error %d\n", GetLastError());
+        result = FALSE;
+        goto exit;
+    }
+
+    threads = (PBENCH_THREAD)calloc(G_ThreadCount, sizeof(BENCH_THREAD));
+    if (threads == NULL) {
+        printf("Could not allocate thread state\n");
+        result = FALSE;
+        goto exit;
+    }
+
+    for (created = 0; created < G_ThreadCount; created++) {
+        threads[created].Thread = CreateThread(NULL,
+                                               0,
+                                               (LPTHREAD_START_ROUTINE) BenchThread,
+                                               &threads[created],
+                                               0,
+                                               NULL);
+        if (threads[created].Thread == NULL) {
+            printf("Couldn't create thread - error %d\n", GetLastError());
+            result = FALSE;
+            break;
+        }
+    }
+
+    //
+    // Threads that failed to open the device return before the start
+    // event, so a failed run still lets the others finish.
+    //
+    QueryPerformanceCounter(&startTime);
+    G_StopTime.QuadPart = startTime.QuadPart + G_Frequency.QuadPart * G_Seconds;
+    SetEvent(G_StartEvent);
+
+    for (i = 0; i < created; i++) {
+        WaitForSingleObject(threads[i].Thread, INFINITE);
+        CloseHandle(threads[i].Thread);
+    }
+
+    if (result) {
+        PrintResults(threads, created, G_StopTime.QuadPart - startTime.QuadPart);
+    }
+
+exit:
+
+    if (threads != NULL) {
+        for (i = 0; i < created; i++) {
+            free(threads[i].Reads.Latency);
+            free(threads[i].Writes.Latency);
+        }
+        free(threads);
+    }
+
+    if (G_StartEvent != NULL) {
+        CloseHandle(G_StartEvent);
+    }
+
+    return ((result == TRUE) ? 0 : 1);
+}
+
+BOOLEAN
+AddSample(
+    _Inout_ PBENCH_SAMPLES Samples,
+    _In_ LONGLONG Latency
+    )
+{
+    PLONGLONG latency;
+    ULONG capacity;
+
+    if (Samples->Count == Samples->Capacity) {
+        capacity = (Samples->Capacity == 0) ? 65536 : Samples->Capacity * 2;
+        latency = (PLONGLONG)realloc(Samples->Latency, capacity * sizeof(LONGLONG));
+        if (latency == NULL) {
+            return FALSE;
+        }
+        Samples->Latency = latency;
+        Samples->Capacity = capacity;
+    }
+
+    Samples->Latency[Samples->Count++] = Latency;
+    return TRUE;
+}
+
+BOOLEAN
+IssueRequest(
+    _Inout_ PBENCH_THREAD Context,
+    _Inout_ PBENCH_SLOT Slot
+    )
+/*++
+
+Routine Description:
+
+    Sends the slot's next read or write. A request that completes at once
+    still queues a completion packet to the port, so it is counted as
+    outstanding either way.
+
+--*/
+{
+    BOOL bRc;
+
+    ZeroMemory(&Slot->Overlapped, sizeof(Slot->Overlapped));
+    QueryPerformanceCounter(&Slot->IssueTime);
+
+    if (Slot->IsWrite) {
+        bRc = WriteFile(Context->hDevice, Slot->Buffer, G_RequestSize,
+                        NULL, &Slot->Overlapped);
+    } else {
+        bRc = ReadFile(Context->hDevice, Slot->Buffer, G_RequestSize,
+                       NULL, &Slot->Overlapped);
+    }
+
+    if (!bRc && GetLastError() != ERROR_IO_PENDING) {
+        if (Context->Errors++ == 0) {
+            Context->FirstError = GetLastError();
+        }
+        return FALSE;
+    }
+
+    Context->Outstanding++;
+    return TRUE;
+}
+
+ULONG
+BenchThread(
+    PVOID   ThreadParameter
+    )
+{
+    PBENCH_THREAD context = (PBENCH_THREAD)ThreadParameter;
+    PBENCH_SLOT slot;
+    LPOVERLAPPED overlapped;
+    LARGE_INTEGER now;
+    ULONG_PTR key;
+    DWORD bytes;
+    BOOLEAN stopping = FALSE;
+    BOOL bRc;
+    ULONG i;
+
+    context->hDevice = CreateFile(G_DevicePath,
+                                  GENERIC_WRITE|GENERIC_READ,
+                                  FILE_SHARE_WRITE | FILE_SHARE_READ,
+                                  NULL,
+                                  OPEN_EXISTING,
+                                  FILE_FLAG_OVERLAPPED,
+                                  NULL);
+
+    if (context->hDevice == INVALID_HANDLE_VALUE) {
+        printf("Cannot open %ws error %d\n", G_DevicePath, GetLastError());
+        return 0;
+    }
+
+    context->Port = CreateIoCompletionPort(context->hDevice, NULL, 1, 0);
+    if (context->Port == NULL) {
+        printf("Cannot open completion port %d \n",GetLastError());
+        goto Error;
+    }
+
+    for (i = 0; i < G_QueueDepth; i++) {
+        context->Slots[i].Buffer = (PUCHAR)malloc(G_RequestSize);
+        if (context->Slots[i].Buffer == NULL) {
+            printf("Could not allocate %d byte buffer\n", G_RequestSize);
+            goto Error;
+        }
+        FillMemory(context->Slots[i].Buffer, G_RequestSize, (UCHAR)i);
+        context->Slots[i].IsWrite = ((i % 2) == 0);
+    }
+
+    WaitForSingleObject(G_StartEvent, INFINITE);
+
+    for (i = 0; i < G_QueueDepth; i++) {
+        IssueRequest(context, &context->Slots[i]);
+    }
+
+    while (context->Outstanding != 0) {
+
+        bRc = GetQueuedCompletionStatus(context->Port, &bytes, &key,
+                                        &overlapped, INFINITE);
+        if (overlapped == NULL) {
+            printf("GetQueuedCompletionStatus failed - error %d\n", GetLastError());
+            break;
+        }
+
+        QueryPerformanceCounter(&now);
+        context->Outstanding--;
+
+        slot = CONTAINING_RECORD(overlapped, BENCH_SLOT, Overlapped);
+
+        //
+        // Requests cancelled at the end of the run are neither errors nor
+        // samples.
+        //
+        if (stopping) {
+            continue;
+        }
+
+        if (bRc) {
+            if (!AddSample(slot->IsWrite ? &context->Writes : &context->Reads,
+                           now.QuadPart - slot->IssueTime.QuadPart)) {
+                printf("Could not allocate latency samples\n");
+                stopping = TRUE;
+            }
+        } else if (context->Errors++ == 0) {
+            context->FirstError = GetLastError();
+        }
+
+        if (now.QuadPart >= G_StopTime.QuadPart) {
+            stopping = TRUE;
+        }
+
+        if (stopping) {
+            //
+            // Drivers that complete requests from a timer may hold the
+            // rest for a long time; cancel them so the run ends on time.
+            //
+            CancelIoEx(context->hDevice, NULL);
+            continue;
+        }
+
+        slot->IsWrite = !slot->IsWrite;
+        IssueRequest(context, slot);
+    }
+
+Error:
+
+    for (i = 0; i < G_QueueDepth; i++) {
+        free(context->Slots[i].Buffer);
+    }
+
+    if (context->Port != NULL) {
+        CloseHandle(context->Port);
+    }
+
+    CloseHandle(context->hDevice);
+
+    return 0;
+}
+
+int __cdecl
+CompareLatency(
+    const void* Left,
+    const void* Right
+    )
+{
+    LONGLONG left = *(const LONGLONG*)Left;
+    LONGLONG right = *(const LONGLONG*)Right;
+
+    return (left < right) ? -1 : (left > right) ? 1 : 0;
+}
+
+VOID
+PrintLatency(
+    _In_z_ const char* Name,
+    _In_reads_(ThreadCount) PBENCH_THREAD Threads,
+    _In_ ULONG ThreadCount,
+    _In_ BOOLEAN Writes
+    )
+/*++
+
+Routine Description:
+
+    Merges the samples of all threads for one kind of request and prints
+    their percentiles in microseconds.
+
+--*/
+{
+    static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+    PBENCH_SAMPLES samples;
+    PLONGLONG merged;
+    ULONG count = 0;
+    ULONG i, index;
+
+    for (i = 0; i < ThreadCount; i++) {
+        count += (Writes ? &Threads[i].Writes : &Threads[i].Reads)->Count;
+    }
+
+    if (count == 0) {
+        printf("    %-6s  no requests completed\n", Name);
+        return;
+    }
+
+    merged = (PLONGLONG)malloc(count * sizeof(LONGLONG));
+    if (merged == NULL) {
+        printf("Could not allocate %d latency samples\n", count);
+        return;
+    }
+
+    count = 0;
+    for (i = 0; i < ThreadCount; i++) {
+        samples = Writes ? &Threads[i].Writes : &Threads[i].Reads;
+        CopyMemory(merged + count, samples->Latency, samples->Count * sizeof(LONGLONG));
+        count += samples->Count;
+    }
+
+    qsort(merged, count, sizeof(LONGLONG), CompareLatency);
+
+    printf("    %-6s", Name);
+    for (i = 0; i < ARRAYSIZE(percentiles); i++) {
+        index = (ULONG)(percentiles[i] / 100.0 * (count - 1));
+        printf("  %10.1f", merged[index] * 1000000.0 / G_Frequency.QuadPart);
+    }
+    printf("  %10.1f\n", merged[count - 1] * 1000000.0 / G_Frequency.QuadPart);
+
+    free(merged);
+}
+
+VOID
+PrintResults(
+    _In_reads_(ThreadCount) PBENCH_THREAD Threads,
+    _In_ ULONG ThreadCount,
+    _In_ LONGLONG ElapsedTicks
+    )
+{
+    ULONGLONG reads = 0, writes = 0;
+    ULONG errors = 0;
+    DWORD firstError = ERROR_SUCCESS;
+    double seconds = (double)ElapsedTicks / G_Frequency.QuadPart;
+    ULONG i;
+
+    for (i = 0; i < ThreadCount; i++) {
+        reads += Threads[i].Reads.Count;
+        writes += Threads[i].Writes.Count;
+        if (firstError == ERROR_SUCCESS) {
+            firstError = Threads[i].FirstError;
+        }
+        errors += Threads[i].Errors;
+    }
+
+    printf("\n");
+    printf("    Reads        : %I64u (%.0f/s)\n", reads, reads / seconds);
+    printf("    Writes       : %I64u (%.0f/s)\n", writes, writes / seconds);
+    printf("    IOPS         : %.0f\n", (reads + writes) / seconds);
+    printf("    Throughput   : %.2f MB/s\n",
+           (reads + writes) * G_RequestSize / seconds / (1024.0 * 1024.0));
+
+    if (errors != 0) {
+        printf("    Errors       : %d (first error %d)\n", errors, firstError);
+    }
+
+    printf("\n    Latency (us)       p50         p90         p99       p99.9         max\n");
+    PrintLatency("Write", Threads, ThreadCount, TRUE);
+    PrintLatency("Read", Threads, ThreadCount, FALSE);
+}
+
+BOOL
+GetDevicePath(
+    _In_ LPGUID InterfaceGuid,
+    _In_ ULONG Index,
+    _In_ BOOLEAN List,
+    _Out_writes_(BufLen) PWCHAR DevicePath,
+    _In_ size_t BufLen
+    )
+/*++
+
+Routine Description:
+
+    Finds the Index'th present device interface of the given class, or
+    prints them all if List is set. Every version of the echo driver
+    registers the same interface class, so with more than one installed
+    the index picks which one to run against.
+
+--*/
+{
+    CONFIGRET cr = CR_SUCCESS;
+    PWSTR deviceInterfaceList = NULL;
+    ULONG deviceInterfaceListLength = 0;
+    PWSTR nextInterface;
+    HRESULT hr = E_FAIL;
+    BOOL bRet = TRUE;
+    ULONG i;
+
+    cr = CM_Get_Device_Interface_List_Size(
+                &deviceInterfaceListLength,
+                InterfaceGuid,
+                NULL,
+                CM_GET_DEVICE_INTERFACE_LIST_PRESENT);
+    if (cr != CR_SUCCESS) {
+        printf("Error 0x%x retrieving device interface list size.\n", cr);
+        goto clean0;
+    }
+
+    if (deviceInterfaceListLength <= 1) {
+        bRet = FALSE;
+        printf("Error: No active device interfaces found.\n"
+            " Is the sample driver loaded?");
+        goto clean0;
+    }
+
+    deviceInterfaceList = (PWSTR)malloc(deviceInterfaceListLength * sizeof(WCHAR));
+    if (deviceInterfaceList == NULL) {
+        printf("Error allocating memory for device interface list.\n");
+        goto clean0;
+    }
+    ZeroMemory(deviceInterfaceList, deviceInterfaceListLength * sizeof(WCHAR));
+
+    cr = CM_Get_Device_Interface_List(
+                InterfaceGuid,
+                NULL,
+                deviceInterfaceList,
+                deviceInterfaceListLength,
+                CM_GET_DEVICE_INTERFACE_LIST_PRESENT);
+    if (cr != CR_SUCCESS) {
+        printf("Error 0x%x retrieving device interface list.\n", cr);
+        goto clean0;
+    }
+
+    nextInterface = deviceInterfaceList;
+    for (i = 0; *nextInterface != UNICODE_NULL; i++) {
+        if (List) {
+            printf("%d: %ws\n", i, nextInterface);
+        } else if (i == Index) {
+            break;
+        }
+        nextInterface += wcslen(nextInterface) + 1;
+    }
+
+    if (List) {
+        goto clean0;
+    }
+
+    if (*nextInterface == UNICODE_NULL) {
+        bRet = FALSE;
+        printf("Error: Only %d device interfaces found.\n", i);
+        goto clean0;
+    }
+
+    hr = StringCchCopy(DevicePath, BufLen, nextInterface);
+    if (FAILED(hr)) {
+        bRet = FALSE;
+        printf("Error: StringCchCopy failed with HRESULT 0x%x", hr);
+        goto clean0;
+    }
+
+clean0:
+    if (deviceInterfaceList != NULL) {
+        free(deviceInterfaceList);
+    }
+    if (CR_SUCCESS != cr) {
+        bRet = FALSE;
+    }
+
+    return bRet;
+}
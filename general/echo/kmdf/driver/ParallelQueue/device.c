@@ -0,0 +1,104 @@
+/*++
+
+Copyright (c) 1990-2000  Microsoft Corporation
+
+Module Name:
+
+    device.c - Device handling events for example driver.
+
+Abstract:
+
+    This is a C version of a very simple sample driver that illustrates
+    how to use the driver framework and demonstrates best practices.
+
+--*/
+
+#include "driver.h"
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text (PAGE, EchoDeviceCreate)
+#endif
+
+
+NTSTATUS
+EchoDeviceCreate(
+    PWDFDEVICE_INIT DeviceInit
+    )
+/*++
+
+Routine Description:
+
+    Worker routine called to create a device and its software resources.
+
+Arguments:
+
+    DeviceInit - Pointer to an opaque init structure. Memory for this
+                    structure will be freed by the framework when the WdfDeviceCreate
+                    succeeds. So don't access the structure after that point.
+
+Return Value:
+
+    NTSTATUS
+
+--*/
+{
+    WDF_OBJECT_ATTRIBUTES attributes;
+    PDEVICE_CONTEXT deviceContext;
+    WDFDEVICE device;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    //
+    // There is no timer to start and stop, so unlike the other versions of
+    // this sample no self managed I/O callbacks are registered. The queues
+    // are power managed, so the framework stops and restarts dispatching
+    // around low power states by itself.
+    //
+
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, DEVICE_CONTEXT);
+
+    //
+    // By not setting the synchronization scope and using the default, there is
+    // no locking between any of the callbacks in this driver.
+    //
+    // The default queue is a parallel queue, so EvtIoRead and EvtIoWrite run
+    // concurrently with each other and on several processors at once. They
+    // synchronize the buffer FIFO using a spinlock in the queue context.
+    //
+    // attributes.SynchronizationScope = ...
+
+    status = WdfDeviceCreate(&DeviceInit, &attributes, &device);
+
+    if (NT_SUCCESS(status)) {
+        //
+        // Get the device context and initialize it. WdfObjectGet_DEVICE_CONTEXT is an
+        // inline function generated by WDF_DECLARE_CONTEXT_TYPE macro in the
+        // device.h header file. This function will do the type checking and return
+        // the device context. If you pass a wrong object  handle
+        // it will return NULL and assert if run under framework verifier mode.
+        //
+        deviceContext = WdfObjectGet_DEVICE_CONTEXT(device);
+        deviceContext->PrivateDeviceData = 0;
+
+        //
+        // Create a device interface so that application can find and talk
+        // to us.
+        //
+        status = WdfDeviceCreateDeviceInterface(
+            device,
+            &GUID_DEVINTERFACE_ECHO,
+            NULL // ReferenceString
+            );
+
+        if (NT_SUCCESS(status)) {
+            //
+            // Initialize the I/O Package and any Queues
+            //
+            status = EchoQueueInitialize(device);
+        }
+    }
+
+    return status;
+}
+
@@ -0,0 +1,190 @@
+/*++
+
+Copyright (c) 1990-2000  Microsoft Corporation
+
+Module Name:
+
+    driver.c
+
+Abstract:
+
+    This driver demonstrates use of a parallel default I/O Queue, so that
+    any number of read and write requests can be outstanding in the driver
+    at once.
+
+    Written data is kept in a FIFO of fixed size buffers allocated from a
+    lookaside list. A read takes the oldest buffer off the FIFO, and if
+    the FIFO is empty the read waits in a manual queue until a write
+    arrives and completes it directly. Every request is completed from the
+    I/O callbacks; there is no timer, and the framework cancels reads
+    waiting in the manual queue without a driver cancel routine.
+
+    This variant is meant as a baseline for the cost of dispatching and
+    completing requests through the framework.
+
+--*/
+
+#include "driver.h"
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text (INIT, DriverEntry)
+#pragma alloc_text (INIT, EchoPrintDriverVersion)
+#pragma alloc_text (PAGE, EchoEvtDeviceAdd)
+#endif
+
+
+NTSTATUS
+DriverEntry(
+    IN PDRIVER_OBJECT  DriverObject,
+    IN PUNICODE_STRING RegistryPath
+    )
+/*++
+
+Routine Description:
+    DriverEntry initializes the driver and is the first routine called by the
+    system after the driver is loaded. DriverEntry specifies the other entry
+    points in the function driver, such as EvtDevice and DriverUnload.
+
+Parameters Description:
+
+    DriverObject - represents the instance of the function driver that is loaded
+    into memory. DriverEntry must initialize members of DriverObject before it
+    returns to the caller. DriverObject is allocated by the system before the
+    driver is loaded, and it is released by the system after the system unloads
+    the function driver from memory.
+
+    RegistryPath - represents the driver specific path in the Registry.
+    The function driver can use the path to store driver related data between
+    reboots. The path does not store hardware instance specific data.
+
+Return Value:
+
+    STATUS_SUCCESS if successful,
+    STATUS_UNSUCCESSFUL otherwise.
+
+--*/
+{
+    WDF_DRIVER_CONFIG config;
+    NTSTATUS status;
+
+    WDF_DRIVER_CONFIG_INIT(&config,
+                        EchoEvtDeviceAdd
+                        );
+
+    status = WdfDriverCreate(DriverObject,
+                            RegistryPath,
+                            WDF_NO_OBJECT_ATTRIBUTES,
+                            &config,
+                            WDF_NO_HANDLE);
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("Error: WdfDriverCreate failed 0x%x\n", status));
+        return status;
+    }
+
+#if DBG
+    EchoPrintDriverVersion();
+#endif
+
+    return status;
+}
+
+NTSTATUS
+EchoEvtDeviceAdd(
+    IN WDFDRIVER       Driver,
+    IN PWDFDEVICE_INIT DeviceInit
+    )
+/*++
+Routine Description:
+
+    EvtDeviceAdd is called by the framework in response to AddDevice
+    call from the PnP manager. We create and initialize a device object to
+    represent a new instance of the device.
+
+Arguments:
+
+    Driver - Handle to a framework driver object created in DriverEntry
+
+    DeviceInit - Pointer to a framework-allocated WDFDEVICE_INIT structure.
+
+Return Value:
+
+    NTSTATUS
+
+--*/
+{
+    NTSTATUS status;
+
+    UNREFERENCED_PARAMETER(Driver);
+
+    PAGED_CODE();
+
+    KdPrint(("Enter  EchoEvtDeviceAdd\n"));
+
+    status = EchoDeviceCreate(DeviceInit);
+
+    return status;
+}
+
+NTSTATUS
+EchoPrintDriverVersion(
+    )
+/*++
+Routine Description:
+
+   This routine shows how to retrieve framework version string and
+   also how to find out to which version of framework library the
+   client driver is bound to.
+
+Arguments:
+
+Return Value:
+
+    NTSTATUS
+
+--*/
+{
+    NTSTATUS status;
+    WDFSTRING string;
+    UNICODE_STRING us;
+    WDF_DRIVER_VERSION_AVAILABLE_PARAMS ver;
+
+    //
+    // 1) Retreive version string and print that in the debugger.
+    //
+    status = WdfStringCreate(NULL, WDF_NO_OBJECT_ATTRIBUTES, &string);
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("Error: WdfStringCreate failed 0x%x\n", status));
+        return status;
+    }
+
+    status = WdfDriverRetrieveVersionString(WdfGetDriver(), string);
+    if (!NT_SUCCESS(status)) {
+        //
+        // No need to worry about delete the string object because
+        // by default it's parented to the driver and it will be
+        // deleted when the driverobject is deleted when the DriverEntry
+        // returns a failure status.
+        //
+        KdPrint(("Error: WdfDriverRetrieveVersionString failed 0x%x\n", status));
+        return status;
+    }
+
+    WdfStringGetUnicodeString(string, &us);
+    KdPrint(("Echo Sample %wZ\n", &us));
+
+    WdfObjectDelete(string);
+    string = NULL; // To avoid referencing a deleted object.
+
+    //
+    // 2) Find out to which version of framework this driver is bound to.
+    //
+    WDF_DRIVER_VERSION_AVAILABLE_PARAMS_INIT(&ver, 1, 0);
+    if (WdfDriverIsVersionAvailable(WdfGetDriver(), &ver) == TRUE) {
+        KdPrint(("Yes, framework version is 1.0\n"));
+    }else {
+        KdPrint(("No, framework verison is not 1.0\n"));
+    }
+
+    return STATUS_SUCCESS;
+}
+
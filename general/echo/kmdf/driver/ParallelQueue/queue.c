@@ -0,0 +1,491 @@
+/*++
+
+Copyright (c) 1990-2000  Microsoft Corporation
+
+Module Name:
+
+    queue.c
+
+Abstract:
+
+    This is a C version of a very simple sample driver that illustrates
+    how to use the driver framework and demonstrates best practices.
+
+--*/
+
+#include "driver.h"
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text (PAGE, EchoQueueInitialize)
+#endif
+
+NTSTATUS
+EchoQueueInitialize(
+    WDFDEVICE Device
+    )
+/*++
+
+Routine Description:
+
+
+     The I/O dispatch callbacks for the frameworks device object
+     are configured in this function.
+
+     A single default I/O Queue is configured for parallel request
+     processing, and a driver context memory allocation is created
+     to hold our structure QUEUE_CONTEXT.
+
+     A second, manual queue holds the reads that arrive while there
+     is nothing to read. Requests in a manual queue are cancelled by
+     the framework, so the driver needs no cancel routine.
+
+     The lifetime of this memory is tied to the lifetime of the I/O
+     Queue object, and we register an optional cleanup callback
+     to release any buffers still in the FIFO.
+
+
+Arguments:
+
+    Device - Handle to a framework device object.
+
+Return Value:
+
+    NTSTATUS
+
+--*/
+{
+    WDFQUEUE queue;
+    NTSTATUS status;
+    PQUEUE_CONTEXT queueContext;
+    WDF_IO_QUEUE_CONFIG queueConfig;
+    WDF_OBJECT_ATTRIBUTES attributes;
+
+    PAGED_CODE();
+
+    //
+    // Configure a default queue so that requests that are not
+    // configure-fowarded using WdfDeviceConfigureRequestDispatching to goto
+    // other queues get dispatched here.
+    //
+    WDF_IO_QUEUE_CONFIG_INIT_DEFAULT_QUEUE(
+         &queueConfig,
+        WdfIoQueueDispatchParallel
+        );
+
+    queueConfig.EvtIoRead   = EchoEvtIoRead;
+    queueConfig.EvtIoWrite  = EchoEvtIoWrite;
+
+    //
+    // Fill in a callback for cleanup, and our QUEUE_CONTEXT size. Cleanup,
+    // unlike destroy, runs before the lookaside list parented to the queue
+    // is deleted, so the buffers can still be returned to it.
+    //
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, QUEUE_CONTEXT);
+    attributes.EvtCleanupCallback = EchoEvtIoQueueContextCleanup;
+
+    status = WdfIoQueueCreate(
+        Device,
+        &queueConfig,
+        &attributes,
+        &queue
+        );
+
+    if( !NT_SUCCESS(status) ) {
+        KdPrint(("WdfIoQueueCreate failed 0x%x\n",status));
+        return status;
+    }
+
+    // Get our Driver Context memory from the returned Queue handle
+    queueContext = QueueGetContext(queue);
+
+    InitializeListHead(&queueContext->BufferList);
+    queueContext->BufferCount = 0;
+
+    //
+    // Create the SpinLock.
+    //
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject = queue;
+
+    status = WdfSpinLockCreate(&attributes, &queueContext->SpinLock);
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfSpinLockCreate failed 0x%x\n",status));
+        return status;
+    }
+
+    //
+    // Create the lookaside list the written buffers come from.
+    //
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject = queue;
+
+    status = WdfLookasideListCreate(&attributes,
+                                    sizeof(ECHO_BUFFER),
+                                    NonPagedPool,
+                                    WDF_NO_OBJECT_ATTRIBUTES,
+                                    'sam1',
+                                    &queueContext->BufferLookaside);
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfLookasideListCreate failed 0x%x\n",status));
+        return status;
+    }
+
+    //
+    // Create the manual queue for reads that have to wait.
+    //
+    WDF_IO_QUEUE_CONFIG_INIT(&queueConfig, WdfIoQueueDispatchManual);
+
+    status = WdfIoQueueCreate(
+        Device,
+        &queueConfig,
+        WDF_NO_OBJECT_ATTRIBUTES,
+        &queueContext->PendingReadQueue
+        );
+
+    if( !NT_SUCCESS(status) ) {
+        KdPrint(("WdfIoQueueCreate for pending reads failed 0x%x\n",status));
+        return status;
+    }
+
+    return status;
+}
+
+
+VOID
+EchoEvtIoQueueContextCleanup(
+    WDFOBJECT Object
+)
+/*++
+
+Routine Description:
+
+    This is called when the Queue that our driver context memory
+    is associated with is being deleted.
+
+Arguments:
+
+    Object - The queue being deleted.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    PQUEUE_CONTEXT queueContext = QueueGetContext(Object);
+    PECHO_BUFFER buffer;
+
+    //
+    // Return any buffers that were written but never read.
+    //
+    while (!IsListEmpty(&queueContext->BufferList)) {
+        buffer = CONTAINING_RECORD(RemoveHeadList(&queueContext->BufferList),
+                                   ECHO_BUFFER,
+                                   ListEntry);
+        WdfObjectDelete(buffer->Memory);
+    }
+
+    queueContext->BufferCount = 0;
+
+    return;
+}
+
+VOID
+EchoCompleteRead(
+    IN WDFREQUEST Request,
+    IN size_t     Length,
+    _In_reads_bytes_(DataLength) PVOID Data,
+    IN ULONG      DataLength
+    )
+/*++
+
+Routine Description:
+
+    Copies the written data into a read request and completes it. A read
+    shorter than the data gets as much as fits.
+
+Arguments:
+
+    Request - Handle to the read request.
+
+    Length  - Length of the read request.
+
+    Data, DataLength - The written data.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    NTSTATUS Status;
+    WDFMEMORY memory;
+
+    if( DataLength < Length ) {
+        Length = DataLength;
+    }
+
+    Status = WdfRequestRetrieveOutputMemory(Request, &memory);
+    if( !NT_SUCCESS(Status) ) {
+        KdPrint(("EchoCompleteRead Could not get request memory buffer 0x%x\n",Status));
+        WdfVerifierDbgBreakPoint();
+        WdfRequestCompleteWithInformation(Request, Status, 0L);
+        return;
+    }
+
+    // Copy the memory out
+    Status = WdfMemoryCopyFromBuffer( memory, // destination
+                             0,      // offset into the destination memory
+                             Data,
+                             Length );
+    if( !NT_SUCCESS(Status) ) {
+        KdPrint(("EchoCompleteRead: WdfMemoryCopyFromBuffer failed 0x%x\n", Status));
+        WdfRequestComplete(Request, Status);
+        return;
+    }
+
+    WdfRequestCompleteWithInformation(Request, STATUS_SUCCESS, (ULONG_PTR)Length);
+}
+
+VOID
+EchoEvtIoRead(
+    IN WDFQUEUE   Queue,
+    IN WDFREQUEST Request,
+    IN size_t      Length
+    )
+/*++
+
+Routine Description:
+
+    This event is called when the framework receives IRP_MJ_READ request.
+    It takes the oldest written buffer off the FIFO, copies it to the request
+    buffer and completes the request. If nothing has been written, the request
+    is forwarded to the pending read queue, where the next write completes it.
+
+Arguments:
+
+    Queue -  Handle to the framework queue object that is associated with the
+            I/O request.
+    Request - Handle to a framework request object.
+
+    Length  - number of bytes to be read.
+                 The default property of the queue is to not dispatch
+                 zero lenght read & write requests to the driver and
+                 complete is with status success. So we will never get
+                 a zero length request.
+
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    PQUEUE_CONTEXT queueContext = QueueGetContext(Queue);
+    PECHO_BUFFER buffer = NULL;
+
+    _Analysis_assume_(Length > 0);
+
+    KdPrint(("EchoEvtIoRead Called! Queue 0x%p, Request 0x%p Length %Iu\n",
+                            Queue,Request,Length));
+
+    //
+    // Taking a buffer and parking the read are done under one lock, so a
+    // write either sees this read waiting or leaves its data in the FIFO
+    // for it; BufferList and PendingReadQueue are never both non-empty.
+    //
+    WdfSpinLockAcquire(queueContext->SpinLock);
+
+    if (!IsListEmpty(&queueContext->BufferList)) {
+        buffer = CONTAINING_RECORD(RemoveHeadList(&queueContext->BufferList),
+                                   ECHO_BUFFER,
+                                   ListEntry);
+        queueContext->BufferCount--;
+    }
+    else {
+        Status = WdfRequestForwardToIoQueue(Request,
+                                            queueContext->PendingReadQueue);
+    }
+
+    WdfSpinLockRelease(queueContext->SpinLock);
+
+    if (buffer == NULL) {
+        //
+        // The read is owned by the pending read queue now, unless the
+        // forward failed.
+        //
+        if (!NT_SUCCESS(Status)) {
+            KdPrint(("EchoEvtIoRead: WdfRequestForwardToIoQueue failed 0x%x\n", Status));
+            WdfRequestCompleteWithInformation(Request, Status, 0L);
+        }
+        return;
+    }
+
+    EchoCompleteRead(Request, Length, buffer->Data, buffer->Length);
+
+    WdfObjectDelete(buffer->Memory);
+
+    return;
+}
+
+VOID
+EchoEvtIoWrite(
+    IN WDFQUEUE   Queue,
+    IN WDFREQUEST Request,
+    IN size_t     Length
+    )
+/*++
+
+Routine Description:
+
+    This event is invoked when the framework receives IRP_MJ_WRITE request.
+    If a read is waiting, the data is copied straight into it and both
+    requests are completed. Otherwise the data is copied into a buffer from
+    the lookaside list and appended to the FIFO, and the write is completed.
+
+Arguments:
+
+    Queue -  Handle to the framework queue object that is associated with the
+            I/O request.
+    Request - Handle to a framework request object.
+
+    Length  - number of bytes to be read.
+                 The default property of the queue is to not dispatch
+                 zero lenght read & write requests to the driver and
+                 complete is with status success. So we will never get
+                 a zero length request.
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    NTSTATUS Status;
+    WDFMEMORY memory;
+    WDFMEMORY bufferMemory;
+    WDFREQUEST readRequest;
+    WDF_REQUEST_PARAMETERS params;
+    PECHO_BUFFER buffer;
+    PQUEUE_CONTEXT queueContext = QueueGetContext(Queue);
+
+    _Analysis_assume_(Length > 0);
+
+    KdPrint(("EchoEvtIoWrite Called! Queue 0x%p, Request 0x%p Length %Iu\n",
+                            Queue,Request,Length));
+
+    if( Length > MAX_WRITE_LENGTH ) {
+        KdPrint(("EchoEvtIoWrite Buffer Length to big %Iu, Max is %d\n",
+                 Length,MAX_WRITE_LENGTH));
+        WdfRequestCompleteWithInformation(Request, STATUS_BUFFER_OVERFLOW, 0L);
+        return;
+    }
+
+    // Get the memory buffer
+    Status = WdfRequestRetrieveInputMemory(Request, &memory);
+    if( !NT_SUCCESS(Status) ) {
+        KdPrint(("EchoEvtIoWrite Could not get request memory buffer 0x%x\n",
+                 Status));
+        WdfVerifierDbgBreakPoint();
+        WdfRequestComplete(Request, Status);
+        return;
+    }
+
+    //
+    // Reads only wait while the FIFO is empty, so if one is waiting this
+    // write is next in line for it and can skip the FIFO. This is checked
+    // again under the lock below; the unlocked check just saves the copy
+    // into a buffer in the common case of reads posted ahead of writes.
+    //
+    Status = WdfIoQueueRetrieveNextRequest(queueContext->PendingReadQueue,
+                                           &readRequest);
+
+    if (!NT_SUCCESS(Status)) {
+
+        Status = WdfMemoryCreateFromLookaside(queueContext->BufferLookaside,
+                                              &bufferMemory);
+        if( !NT_SUCCESS(Status) ) {
+            KdPrint(("EchoEvtIoWrite: WdfMemoryCreateFromLookaside failed 0x%x\n", Status));
+            WdfRequestComplete(Request, Status);
+            return;
+        }
+
+        buffer = (PECHO_BUFFER) WdfMemoryGetBuffer(bufferMemory, NULL);
+        buffer->Memory = bufferMemory;
+        buffer->Length = (ULONG) Length;
+
+        // Copy the memory in
+        Status = WdfMemoryCopyToBuffer( memory,
+                               0,  // offset into the source memory
+                               buffer->Data,
+                               Length );
+        if( !NT_SUCCESS(Status) ) {
+            KdPrint(("EchoEvtIoWrite WdfMemoryCopyToBuffer failed 0x%x\n", Status));
+            WdfVerifierDbgBreakPoint();
+            WdfObjectDelete(bufferMemory);
+            WdfRequestComplete(Request, Status);
+            return;
+        }
+
+        WdfSpinLockAcquire(queueContext->SpinLock);
+
+        Status = WdfIoQueueRetrieveNextRequest(queueContext->PendingReadQueue,
+                                               &readRequest);
+
+        if (!NT_SUCCESS(Status)) {
+            if (queueContext->BufferCount < MAX_QUEUED_BUFFERS) {
+                InsertTailList(&queueContext->BufferList, &buffer->ListEntry);
+                queueContext->BufferCount++;
+                buffer = NULL;
+                Status = STATUS_SUCCESS;
+            }
+            else {
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+            }
+
+            readRequest = NULL;
+        }
+
+        WdfSpinLockRelease(queueContext->SpinLock);
+
+        //
+        // A read that started waiting after the first check gets the
+        // buffer that was just filled.
+        //
+        if (readRequest != NULL) {
+            WDF_REQUEST_PARAMETERS_INIT(&params);
+            WdfRequestGetParameters(readRequest, &params);
+
+            EchoCompleteRead(readRequest,
+                             params.Parameters.Read.Length,
+                             buffer->Data,
+                             buffer->Length);
+        }
+
+        if (buffer != NULL) {
+            WdfObjectDelete(bufferMemory);
+        }
+
+        if (!NT_SUCCESS(Status)) {
+            KdPrint(("EchoEvtIoWrite: %d buffers already queued\n",
+                     MAX_QUEUED_BUFFERS));
+            WdfRequestComplete(Request, Status);
+            return;
+        }
+    }
+    else {
+        WDF_REQUEST_PARAMETERS_INIT(&params);
+        WdfRequestGetParameters(readRequest, &params);
+
+        EchoCompleteRead(readRequest,
+                         params.Parameters.Read.Length,
+                         WdfMemoryGetBuffer(memory, NULL),
+                         (ULONG) Length);
+    }
+
+    WdfRequestCompleteWithInformation(Request, STATUS_SUCCESS, (ULONG_PTR)Length);
+
+    return;
+}
+
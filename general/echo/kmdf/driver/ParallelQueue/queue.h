@@ -0,0 +1,72 @@
+/*++
+
+Copyright (c) 1990-2000  Microsoft Corporation
+
+Module Name:
+
+    queue.h
+
+Abstract:
+
+    This is a C version of a very simple sample driver that illustrates
+    how to use the driver framework and demonstrates best practices.
+
+--*/
+
+// Set max write length for testing
+#define MAX_WRITE_LENGTH 1024*40
+
+// Set the most written buffers that are kept waiting for a read
+#define MAX_QUEUED_BUFFERS 256
+
+//
+// One written buffer waiting in the FIFO. These are allocated from a
+// lookaside list, so they are all big enough for the largest write.
+//
+typedef struct _ECHO_BUFFER {
+
+    LIST_ENTRY  ListEntry;
+
+    // The lookaside memory object this buffer lives in
+    WDFMEMORY   Memory;
+
+    ULONG       Length;
+    UCHAR       Data[MAX_WRITE_LENGTH];
+
+} ECHO_BUFFER, *PECHO_BUFFER;
+
+//
+// This is the context that can be placed per queue
+// and would contain per queue information.
+//
+typedef struct _QUEUE_CONTEXT {
+
+    // Written buffers not yet read, oldest first
+    LIST_ENTRY  BufferList;
+    ULONG       BufferCount;
+
+    WDFLOOKASIDE BufferLookaside;
+
+    // Reads waiting for a write while BufferList is empty
+    WDFQUEUE    PendingReadQueue;
+
+    // SpinLock to synchronize BufferList with PendingReadQueue.
+    WDFSPINLOCK SpinLock;
+
+} QUEUE_CONTEXT, *PQUEUE_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(QUEUE_CONTEXT, QueueGetContext)
+
+NTSTATUS
+EchoQueueInitialize(
+    WDFDEVICE hDevice
+    );
+
+EVT_WDF_OBJECT_CONTEXT_CLEANUP EchoEvtIoQueueContextCleanup;
+
+//
+// Events from the IoQueue object
+//
+EVT_WDF_IO_QUEUE_IO_READ EchoEvtIoRead;
+EVT_WDF_IO_QUEUE_IO_WRITE EchoEvtIoWrite;
+
@@ -137,11 +137,19 @@ Return Value:
     }
 
     //
-    // Create a socket with this infomation recvd in getaddrinfo
+    // Create a socket with this infomation recvd in getaddrinfo. The socket
+    // is opened for overlapped I/O so the file handle I/O target can keep
+    // several reads and writes outstanding on it at once; the host completes
+    // them on its own completion port threads.
     //
-    m_socket = socket(info->ai_family,info->ai_socktype,info->ai_protocol);
-
-    if (m_socket == INVALID_SOCKET) 
+    m_socket = WSASocketW(info->ai_family,
+                          info->ai_socktype,
+                          info->ai_protocol,
+                          NULL,
+                          0,
+                          WSA_FLAG_OVERLAPPED);
+
+    if (m_socket == INVALID_SOCKET)
     {
         DWORD err = WSAGetLastError();
 
@@ -156,6 +164,47 @@ Return Value:
         goto Clean0;
     }
 
+    //
+    // Every write request is a complete message, so send it at once rather
+    // than holding it back for Nagle coalescing, and size the socket buffers
+    // for a full pipeline of the largest requests. These are only hints, so
+    // a failure is traced and otherwise ignored.
+    //
+    BOOL noDelay = TRUE;
+
+    if (setsockopt(m_socket,
+                   IPPROTO_TCP,
+                   TCP_NODELAY,
+                   (char*)&noDelay,
+                   sizeof(noDelay)) == SOCKET_ERROR)
+    {
+        Trace(
+            TRACE_LEVEL_WARNING,
+            L"WARNING: Unable to set TCP_NODELAY %!winerr!",
+            WSAGetLastError()
+            );
+    }
+
+    int bufferSize = SOCKET_BUFFER_SIZE;
+
+    if (setsockopt(m_socket,
+                   SOL_SOCKET,
+                   SO_RCVBUF,
+                   (char*)&bufferSize,
+                   sizeof(bufferSize)) == SOCKET_ERROR ||
+        setsockopt(m_socket,
+                   SOL_SOCKET,
+                   SO_SNDBUF,
+                   (char*)&bufferSize,
+                   sizeof(bufferSize)) == SOCKET_ERROR)
+    {
+        Trace(
+            TRACE_LEVEL_WARNING,
+            L"WARNING: Unable to set socket buffer size %!winerr!",
+            WSAGetLastError()
+            );
+    }
+
     //
     // If that succeeds , proceed to connect to the socket 
     //
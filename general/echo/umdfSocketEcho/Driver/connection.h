@@ -18,6 +18,12 @@ Environment:
 --*/
 #pragma once
 
+//
+// Send and receive buffer size requested for the server connection, enough
+// for several of the largest echo requests to be in flight at once.
+//
+#define SOCKET_BUFFER_SIZE          (256 * 1024)
+
 class CConnection 
 {
 public:
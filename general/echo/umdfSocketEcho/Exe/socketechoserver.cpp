@@ -260,9 +260,445 @@ Exit:
     return ; 
  }
 
+CIocpEchoServer::CIocpEchoServer(
+  SOCKET socketclient,
+  ULONG Depth
+ )
+/*++
+Routine Description:
+
+ This is the constructor routine for CIocpEchoServer class. It is called for each
+ connection accepted by the server when it runs in completion port mode.
+
+Arguments:
+
+    socketclient - Socket received from the accept
+    Depth - Number of buffers, and so of receives kept outstanding, on the connection
+
+Return Value:
+
+  None .
+
+--*/
+{
+    m_socket = socketclient;
+    m_Depth = Depth;
+    m_Io = new ECHO_IO[Depth];
+    m_NextReceive = 0;
+    m_NextSend = 0;
+    m_Outstanding = 0;
+    m_Closing = FALSE;
+
+    if (m_Io != NULL)
+    {
+        ZeroMemory(m_Io, Depth * sizeof(ECHO_IO));
+    }
+
+    InitializeCriticalSection(&m_Lock);
+}
+
+CIocpEchoServer::~CIocpEchoServer(
+ )
+{
+    if (m_socket != INVALID_SOCKET)
+    {
+        closesocket(m_socket);
+    }
+
+    delete[] m_Io;
+    DeleteCriticalSection(&m_Lock);
+}
+
+BOOL
+CIocpEchoServer::Start(
+  HANDLE CompletionPort
+ )
+/*++
+Routine Description:
+
+ This routine associates the socket with the server's completion port and posts the
+ first m_Depth receives. Everything after that happens in OnCompletion on the worker
+ threads.
+
+Arguments:
+
+    CompletionPort - The port the worker threads wait on
+
+Return Value:
+
+  TRUE if the connection has receives outstanding. If FALSE, the caller deletes
+  the object.
+
+--*/
+{
+    BOOL bOk;
+    BOOL noDelay = TRUE;
+
+    if (m_Io == NULL)
+    {
+        printf(" Could not allocate buffers for socket 0x%Ix \n", m_socket);
+        return FALSE;
+    }
+
+    //
+    // Echo each message as soon as it arrives instead of waiting to coalesce it.
+    //
+    setsockopt(m_socket, IPPROTO_TCP, TCP_NODELAY, (char*)&noDelay, sizeof(noDelay));
+
+    if (CreateIoCompletionPort((HANDLE)m_socket,
+                               CompletionPort,
+                               (ULONG_PTR)this,
+                               0) == NULL)
+    {
+        printf(" Could not associate socket with completion port : 0x%lx \n", GetLastError());
+        return FALSE;
+    }
+
+    EnterCriticalSection(&m_Lock);
+    bOk = PostReceives();
+    if (!bOk)
+    {
+        Close();
+    }
+    bOk = (m_Outstanding != 0);
+    LeaveCriticalSection(&m_Lock);
+
+    return bOk;
+}
+
+BOOL
+CIocpEchoServer::PostReceives(
+ )
+/*++
+Routine Description:
+
+ Posts a receive on every free buffer, in sequence order. TCP fills overlapped
+ receives in the order they are posted, so the sequence number of a receive gives
+ the position of its data in the stream however its completion is dequeued.
+ Called with m_Lock held.
+
+Return Value:
+
+  FALSE if a receive could not be posted.
+
+--*/
+{
+    for (;;)
+    {
+        PECHO_IO Io = &m_Io[m_NextReceive % m_Depth];
+        WSABUF wsaBuf;
+        DWORD Flags = 0;
+
+        if (m_Closing || Io->State != EchoIoIdle)
+        {
+            break;
+        }
+
+        ZeroMemory(&Io->Overlapped, sizeof(Io->Overlapped));
+        Io->State = EchoIoReceiving;
+        Io->Length = 0;
+        wsaBuf.buf = Io->Buffer;
+        wsaBuf.len = DATA_LENGTH;
+
+        if (WSARecv(m_socket, &wsaBuf, 1, NULL, &Flags, &Io->Overlapped, NULL) == SOCKET_ERROR &&
+            WSAGetLastError() != WSA_IO_PENDING)
+        {
+            printf(" Could not post receive , Error : 0x%lx \n", WSAGetLastError());
+            Io->State = EchoIoIdle;
+            return FALSE;
+        }
+
+        m_Outstanding++;
+        m_NextReceive++;
+    }
+
+    return TRUE;
+}
+
+BOOL
+CIocpEchoServer::PostSends(
+ )
+/*++
+Routine Description:
+
+ Echoes every received buffer whose predecessors have all been echoed. Sends are
+ posted under m_Lock in sequence order, which keeps the echoed stream in the order
+ it was received. Called with m_Lock held.
+
+Return Value:
+
+  FALSE if a send could not be posted.
+
+--*/
+{
+    for (;;)
+    {
+        PECHO_IO Io = &m_Io[m_NextSend % m_Depth];
+        WSABUF wsaBuf;
+
+        if (m_Closing || Io->State != EchoIoReceived)
+        {
+            break;
+        }
+
+        ZeroMemory(&Io->Overlapped, sizeof(Io->Overlapped));
+        Io->State = EchoIoSending;
+        wsaBuf.buf = Io->Buffer;
+        wsaBuf.len = Io->Length;
+
+        if (WSASend(m_socket, &wsaBuf, 1, NULL, 0, &Io->Overlapped, NULL) == SOCKET_ERROR &&
+            WSAGetLastError() != WSA_IO_PENDING)
+        {
+            printf(" Could not send data , Error : 0x%lx \n", WSAGetLastError());
+            Io->State = EchoIoReceived;
+            return FALSE;
+        }
+
+        m_Outstanding++;
+        m_NextSend++;
+    }
+
+    return TRUE;
+}
+
+void
+CIocpEchoServer::Close(
+ )
+/*++
+Routine Description:
+
+ Stops posting new I/O and closes the socket, which completes the outstanding
+ receives and sends with an error. The object is deleted when the last of them
+ completes. Called with m_Lock held.
+
+--*/
+{
+    if (!m_Closing)
+    {
+        m_Closing = TRUE;
+        printf(" closing client : 0x%Ix \n", m_socket);
+        closesocket(m_socket);
+        m_socket = INVALID_SOCKET;
+    }
+}
+
+void
+CIocpEchoServer::OnCompletion(
+  PECHO_IO Io,
+  BOOL Success,
+  DWORD BytesTransferred
+ )
+/*++
+Routine Description:
+
+ This routine is invoked on a worker thread for each receive or send that completes
+ on the connection. A completed receive is echoed and a completed send frees its
+ buffer for the next receive, both directly from this thread.
+
+Arguments:
+
+    Io - The buffer whose operation completed
+    Success - FALSE if the operation failed
+    BytesTransferred - Bytes received or sent
+
+Return Value:
+
+  None.
+
+--*/
+{
+    BOOL bOk = TRUE;
+    BOOL bDelete;
+
+    EnterCriticalSection(&m_Lock);
+
+    if (Io->State == EchoIoReceiving)
+    {
+        if (!Success || BytesTransferred == 0)
+        {
+            //
+            // The client closed the connection or it was reset.
+            //
+            Io->State = EchoIoIdle;
+            bOk = FALSE;
+        }
+        else
+        {
+            Io->Length = BytesTransferred;
+            Io->State = EchoIoReceived;
+            bOk = PostSends();
+        }
+    }
+    else
+    {
+        //
+        // Overlapped sends on a stream socket complete only once all the data is
+        // sent, so a short send means the connection failed.
+        //
+        Io->State = EchoIoIdle;
+        if (!Success || BytesTransferred != Io->Length)
+        {
+            bOk = FALSE;
+        }
+        else
+        {
+            bOk = PostReceives();
+        }
+    }
+
+    if (!bOk)
+    {
+        Close();
+    }
+
+    m_Outstanding--;
+    bDelete = (m_Closing && m_Outstanding == 0);
+
+    LeaveCriticalSection(&m_Lock);
+
+    if (bDelete)
+    {
+        delete this;
+    }
+}
+
+DWORD
+IocpWorker(
+    LPVOID lpThreadParameter
+   )
+/*++
+Routine Description:
+
+    Worker thread for the completion port mode. Each thread dequeues receive and
+    send completions for any connection and handles them in place.
+
+Arguments:
+
+    lpThreadParameter - The completion port
+
+Return Value:
+
+ Thread Exit Code
+
+--*/
+{
+    HANDLE CompletionPort = (HANDLE)lpThreadParameter;
+
+    for (;;)
+    {
+        DWORD BytesTransferred = 0;
+        ULONG_PTR Key = 0;
+        LPOVERLAPPED pOverlapped = NULL;
+        BOOL Success;
+
+        Success = GetQueuedCompletionStatus(CompletionPort,
+                                            &BytesTransferred,
+                                            &Key,
+                                            &pOverlapped,
+                                            INFINITE);
+        if (pOverlapped == NULL)
+        {
+            printf(" GetQueuedCompletionStatus failed with error 0x%lx \n", GetLastError());
+            break;
+        }
+
+        ((CIocpEchoServer*)Key)->OnCompletion(CONTAINING_RECORD(pOverlapped, ECHO_IO, Overlapped),
+                                              Success,
+                                              BytesTransferred);
+    }
+
+    return 0;
+}
+
+BOOL
+IocpServerLoop(
+  _In_ SOCKET ListenSocket,
+  _In_ ULONG IocpDepth
+  )
+/*++
+Routine Description:
+
+  Accepts connections in completion port mode. One worker thread is started for
+  each processor, and each connection keeps IocpDepth overlapped receives and sends
+  outstanding, so the server is bound by the link rather than by the round trip of
+  a single buffer.
+
+Arguments:
+
+    ListenSocket - The listening socket
+    IocpDepth - Number of buffers per connection
+
+Return Value:
+
+  FALSE if the completion port or its threads could not be created.
+
+--*/
+{
+    SYSTEM_INFO SystemInfo;
+    HANDLE CompletionPort;
+
+    CompletionPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
+    if (NULL == CompletionPort)
+    {
+        printf(" Could not create completion port : 0x%lx \n", GetLastError());
+        return FALSE;
+    }
+
+    GetSystemInfo(&SystemInfo);
+
+    for (DWORD i = 0; i < SystemInfo.dwNumberOfProcessors; i++)
+    {
+        HANDLE hWorkerThread = CreateThread(NULL,
+                                            0,
+                                            (LPTHREAD_START_ROUTINE) IocpWorker,
+                                            CompletionPort,
+                                            0,
+                                            NULL);
+        if (NULL == hWorkerThread)
+        {
+            printf(" Could not create worker thread : 0x%lx \n", GetLastError());
+            if (i == 0)
+            {
+                CloseHandle(CompletionPort);
+                return FALSE;
+            }
+            break;
+        }
+        CloseHandle(hWorkerThread);
+    }
+
+    printf("Completion port mode, %lu buffers per connection.\n", IocpDepth);
+
+    for(;;)
+    {
+        SOCKET sClient = accept(ListenSocket, NULL, NULL);
+
+        if (INVALID_SOCKET == sClient)
+        {
+            printf("Error at accept(): %ld\n", WSAGetLastError());
+            continue;
+        }
+
+        CIocpEchoServer *client = new CIocpEchoServer(sClient, IocpDepth);
+        if (client)
+        {
+            printf("Client connected : 0x%Ix \n", sClient);
+            if (!client->Start(CompletionPort))
+            {
+                delete client;
+            }
+        }
+        else
+        {
+            closesocket(sClient);
+        }
+    }
+}
+
 void 
 SocketServerMain(
-  _In_ unsigned short uPort
+  _In_ unsigned short uPort,
+  _In_ ULONG IocpDepth
   )
 /*++
 
@@ -276,6 +712,9 @@ Routine Description:
 Arguments:
 
     uPort - Port Number that the socket server binds to
+
+    IocpDepth - Buffers per connection in completion port mode, or 0 to serve
+                each connection from its own thread
      
 Return Value:
 
@@ -388,6 +827,13 @@ Return Value:
 // Loop the server to start accepting connections from clients on this socket
 //
 
+    if (IocpDepth != 0)
+    {
+        IocpServerLoop(ListenSocket, IocpDepth);
+        closesocket(ListenSocket);
+        goto Cleanup;
+    }
+
     for(;;)
     {
         CEchoServer *client = new CEchoServer(accept(ListenSocket,NULL,NULL));
@@ -435,6 +881,10 @@ Return Value:
     printf(" socketechoapp -h              Display Usage\n");
     printf(" socketechoapp -p              Start the app as server listening on default port\n");
     printf(" socketechoapp -p [port#]      Start the app as server listening on this port \n");  
+    printf(" socketechoapp -p [port#] -iocp [depth]\n");
+    printf("                               Serve all connections from a completion port,\n");
+    printf("                               keeping depth buffers in flight per connection\n");
+    printf("                               (default %d, maximum %d)\n", DEFAULT_IOCP_DEPTH, MAX_IOCP_DEPTH);
     
 
 
@@ -465,6 +915,7 @@ Return Value:
 {
     unsigned short argIndex   =  1 ;
     unsigned short  uPort         = DEFAULT_PORT_ADDRESS ;
+    ULONG           IocpDepth     = 0;
 
 
     if (argc < 2) 
@@ -491,11 +942,37 @@ Return Value:
     //
     // look at third arg, which should be the port# 
     //
-        if ( ++argIndex < argc )
+        if ( ++argIndex < argc && **(argv+argIndex) != '-' )
         {
              uPort = (unsigned short)atoi(*(argv+(argIndex))); 
+             argIndex++;
         }
-        SocketServerMain(uPort);
+
+    //
+    // an optional -iocp, followed by the number of buffers per connection
+    //
+        if ( argIndex < argc )
+        {
+            if (strcmp(*(argv+argIndex),"-iocp"))
+            {
+                Usage();
+                goto Exit;
+            }
+
+            IocpDepth = DEFAULT_IOCP_DEPTH;
+            if ( ++argIndex < argc )
+            {
+                IocpDepth = (ULONG)atoi(*(argv+argIndex));
+            }
+
+            if (IocpDepth == 0 || IocpDepth > MAX_IOCP_DEPTH)
+            {
+                Usage();
+                goto Exit;
+            }
+        }
+
+        SocketServerMain(uPort, IocpDepth);
 
     }
     else 
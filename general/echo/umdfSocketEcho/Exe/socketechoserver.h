@@ -22,10 +22,13 @@ Environment:
 #define MAX_CONNECTIONS             5
 #define DEFAULT_PORT_ADDRESS        6000
 #define DATA_LENGTH                 1024*40
+#define DEFAULT_IOCP_DEPTH          4
+#define MAX_IOCP_DEPTH              64
  
 void 
 SocketServerMain(
-        _In_ unsigned short uPort
+        _In_ unsigned short uPort,
+        _In_ ULONG IocpDepth
         );
 
     //
@@ -46,3 +49,49 @@ class CEchoServer
       
 };
 
+    //
+    //  State of one buffer of a CIocpEchoServer connection
+    //
+typedef enum _ECHO_IO_STATE
+{
+        EchoIoIdle = 0,                 // free for the next receive
+        EchoIoReceiving,                // WSARecv outstanding
+        EchoIoReceived,                 // data waiting to be echoed
+        EchoIoSending                   // WSASend outstanding
+} ECHO_IO_STATE;
+
+typedef struct _ECHO_IO
+{
+        WSAOVERLAPPED Overlapped;
+        ECHO_IO_STATE State;
+        DWORD Length;
+        char Buffer[DATA_LENGTH];
+} ECHO_IO, *PECHO_IO;
+
+    //
+    //  Class definition for CIocpEchoServer Class. Each connection keeps
+    //  m_Depth receives and sends outstanding and all of them complete to one
+    //  completion port shared by a pool of worker threads.
+    //
+class CIocpEchoServer
+{
+        public:
+        CIocpEchoServer(SOCKET socketclient, ULONG Depth);
+        ~CIocpEchoServer();
+        BOOL Start(HANDLE CompletionPort);
+        void OnCompletion(PECHO_IO Io, BOOL Success, DWORD BytesTransferred);
+
+        private:
+        BOOL PostReceives();
+        BOOL PostSends();
+        void Close();
+
+        SOCKET m_socket;
+        CRITICAL_SECTION m_Lock;
+        ULONG m_Depth;
+        PECHO_IO m_Io;
+        ULONGLONG m_NextReceive;        // sequence number of the next receive to post
+        ULONGLONG m_NextSend;           // sequence number of the next receive to echo
+        ULONG m_Outstanding;
+        BOOL m_Closing;
+};
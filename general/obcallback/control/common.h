@@ -61,6 +61,11 @@ BOOL TcProcessName (
     _In_ ULONG ulOperation
 );
 
+BOOL TcProtectProcessId (
+    _In_ int argc,
+    _In_reads_(argc) LPCWSTR argv[]
+);
+
 BOOL TcUnprotectCallback ();
 
 BOOL TcProcessNameCallback (
@@ -68,6 +73,10 @@ BOOL TcProcessNameCallback (
     _In_ ULONG ulOperation
 );
 
+BOOL TcProtectProcessIdCallback (
+    _In_ ULONG ulProcessId
+);
+
 //
 // Utility functions
 //
@@ -28,11 +28,12 @@ void TcPrintUsage()
 {
     puts ("Usage:");
     puts ("");
-    puts("    ObCallbackTestCtrl.exe -install -name NameofExe -reject NameofExe -uninstall -deprotect [-?]");
+    puts("    ObCallbackTestCtrl.exe -install -name NameofExe -reject NameofExe -pid ProcessId -uninstall -deprotect [-?]");
     puts("     -install        install driver");
     puts("     -uninstall      uninstall driver");
     puts("     -name NameofExe    protect/filter access to NameofExe");
     puts("     -reject NameofExe    prevents execution of NameofExe");
+    puts("     -pid ProcessId  protect/filter access to the running process ProcessId");
     puts("     -deprotect      unprotect/unfilter");
 }
 
@@ -76,6 +77,9 @@ wmain (
         } else
         if (0 == wcscmp (arg, L"-reject")) {
             TcProcessName (argc, argv, TDProtectName_Reject);
+        } else
+        if (0 == wcscmp (arg, L"-pid")) {
+            TcProtectProcessId (argc, argv);
         } else	{
 			puts ("Unknown command!");
 			TcPrintUsage();
@@ -235,6 +239,76 @@ Exit:
 }
 
 
+//
+// TcProtectProcessId
+//
+
+BOOL TcProtectProcessId(
+    _In_ int argc,
+    _In_reads_(argc) LPCWSTR argv[]
+)
+{
+    BOOL ReturnValue = FALSE;
+
+    ULONG ulProcessId = 0;
+
+    LOG_INFO(L"TcProtectProcessId: Entering");
+
+
+    //
+    // Parse command line.
+    //
+    // argv[1] is "-pid" so arg #2 should be the ID of the process to protect
+    //
+
+    if (argc < 3) {
+        LOG_INFO_FAILURE (L"TcProtectProcessId: Too few parameters");
+        LOG_INFO_FAILURE (L"TcProtectProcessId: Usage  -pid ProcessId");
+        goto Exit;
+    }
+
+    ulProcessId = wcstoul (argv[2], NULL, 0);
+
+    if (ulProcessId == 0) {
+        LOG_INFO_FAILURE (L"TcProtectProcessId: invalid process ID %ls", argv[2]);
+        goto Exit;
+    }
+
+
+    //
+    // Open a handle to the device.
+    //
+
+    ReturnValue = TcOpenDevice();
+    if (ReturnValue != TRUE)
+    {
+        LOG_INFO_FAILURE (L"TcProtectProcessId: TcOpenDevice failed");
+        goto Exit;
+    }
+
+
+    //
+    // Send the process ID to protect to the driver
+    //
+    ReturnValue = TcProtectProcessIdCallback(ulProcessId);
+    if (ReturnValue != TRUE)
+    {
+        LOG_INFO_FAILURE (L"TcProtectProcessId: TcProtectProcessIdCallback failed");
+    }
+
+    if (TcCloseDevice() != TRUE)
+    {
+        LOG_INFO_FAILURE (L"TcProtectProcessId: TcCloseDevice failed");
+    }
+
+Exit:
+
+    LOG_INFO(L"TcProtectProcessId: Exiting");
+
+    return ReturnValue;
+}
+
+
 
 //
 // TcInstallDriver  - installs the kernel driver
@@ -120,6 +120,47 @@ Exit:
 }
 
 
+//
+// TcProtectProcessIdCallback
+//
+
+BOOL TcProtectProcessIdCallback (
+    _In_ ULONG ulProcessId
+)
+{
+    TD_PROTECT_PROCESS_ID_INPUT ProtectProcessIdInput = {0};
+    BOOL Result = FALSE;
+    DWORD BytesReturned = 0;
+
+    LOG_INFO (L"TcProtectProcessIdCallback: entering - process ID %lu", ulProcessId);
+
+    ProtectProcessIdInput.ProcessId = ulProcessId;
+
+    Result = DeviceIoControl (
+        TcDeviceHandle,
+        TD_IOCTL_PROTECT_PROCESS_ID,
+        &ProtectProcessIdInput,
+        sizeof(ProtectProcessIdInput),
+        NULL,
+        0,
+        &BytesReturned,
+        NULL
+    );
+
+    if (Result == TRUE)
+    {
+        LOG_INFO (L"TcProtectProcessIdCallback: succeeded");
+    }
+    else
+    {
+        LOG_INFO_FAILURE (L"TcProtectProcessIdCallback: DeviceIoControl failed, last error 0x%x", GetLastError());
+    }
+
+    LOG_INFO (L"TcProtectProcessIdCallback: exiting");
+    return Result;
+}
+
+
 
 //
 // TcInitializeGlobals
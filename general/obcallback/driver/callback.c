@@ -32,10 +32,9 @@ OB_OPERATION_REGISTRATION CBOperationRegistrations[2] = { { 0 }, { 0 } };
 UNICODE_STRING CBAltitude = {0};
 TD_CALLBACK_REGISTRATION CBCallbackRegistration = {0};
 
-// Here is the protected process
+// Here is the name of the process to protect; the processes protected are
+// kept in the table in protect.c
 WCHAR   TdwProtectName[NAME_SIZE+1] = {0};
-PVOID   TdProtectedTargetProcess = NULL;
-HANDLE  TdProtectedTargetProcessId = {0};
 
 
 //
@@ -70,6 +69,68 @@ NTSTATUS TdDeleteProtectNameCallback ()
 }
 
 
+//
+// TdInstallCallbacks
+//
+// Registers the process and thread OB callbacks if they are not registered
+// yet. The caller holds TdCallbacksMutex.
+//
+
+NTSTATUS TdInstallCallbacks ()
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    if (bCallbacksInstalled == TRUE) {
+        return Status;
+    }
+
+    DbgPrintEx (
+        DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL,
+        "ObCallbackTest: TdInstallCallbacks: installing callbacks\n"
+    );
+
+    // Setup the Ob Registration calls
+
+    CBOperationRegistrations[0].ObjectType = PsProcessType;
+    CBOperationRegistrations[0].Operations |= OB_OPERATION_HANDLE_CREATE;
+    CBOperationRegistrations[0].Operations |= OB_OPERATION_HANDLE_DUPLICATE;
+    CBOperationRegistrations[0].PreOperation = CBTdPreOperationCallback;
+    CBOperationRegistrations[0].PostOperation = CBTdPostOperationCallback;
+
+    CBOperationRegistrations[1].ObjectType = PsThreadType;
+    CBOperationRegistrations[1].Operations |= OB_OPERATION_HANDLE_CREATE;
+    CBOperationRegistrations[1].Operations |= OB_OPERATION_HANDLE_DUPLICATE;
+    CBOperationRegistrations[1].PreOperation = CBTdPreOperationCallback;
+    CBOperationRegistrations[1].PostOperation = CBTdPostOperationCallback;
+
+
+    RtlInitUnicodeString (&CBAltitude, L"1000");
+
+    CBObRegistration.Version                    = OB_FLT_REGISTRATION_VERSION;
+    CBObRegistration.OperationRegistrationCount = 2;
+    CBObRegistration.Altitude                   = CBAltitude;
+    CBObRegistration.RegistrationContext        = &CBCallbackRegistration;
+    CBObRegistration.OperationRegistration      = CBOperationRegistrations;
+
+
+    Status = ObRegisterCallbacks (
+        &CBObRegistration,
+        &pCBRegistrationHandle       // save the registration handle to remove callbacks later
+    );
+
+    if (!NT_SUCCESS (Status))   {
+        DbgPrintEx (
+            DPFLTR_IHVDRIVER_ID, DPFLTR_ERROR_LEVEL,
+            "ObCallbackTest: installing OB callbacks failed  status 0x%x\n", Status
+        );
+        return Status;
+    }
+    bCallbacksInstalled = TRUE;
+
+    return Status;
+}
+
+
 //
 // TdProtectNameCallback
 //
@@ -107,66 +168,94 @@ NTSTATUS TdProtectNameCallback (
 
     // Need to enable the OB callbacks
     // once the process is matched to a newly created process, the callbacks will protect the process
-    if (bCallbacksInstalled == FALSE) {
-        DbgPrintEx (
-            DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL,
-            "ObCallbackTest: TdProtectNameCallback: installing callbacks\n"
-        );
+    Status = TdInstallCallbacks ();
+    if (!NT_SUCCESS (Status))   {
+        KeReleaseGuardedMutex (&TdCallbacksMutex); // Release the lock before exit
+        goto Exit;
+    }
+
 
-        // Setup the Ob Registration calls
+    KeReleaseGuardedMutex (&TdCallbacksMutex);
 
-        CBOperationRegistrations[0].ObjectType = PsProcessType;
-        CBOperationRegistrations[0].Operations |= OB_OPERATION_HANDLE_CREATE;
-        CBOperationRegistrations[0].Operations |= OB_OPERATION_HANDLE_DUPLICATE;
-        CBOperationRegistrations[0].PreOperation = CBTdPreOperationCallback;
-        CBOperationRegistrations[0].PostOperation = CBTdPostOperationCallback;
 
-        CBOperationRegistrations[1].ObjectType = PsThreadType;
-        CBOperationRegistrations[1].Operations |= OB_OPERATION_HANDLE_CREATE;
-        CBOperationRegistrations[1].Operations |= OB_OPERATION_HANDLE_DUPLICATE;
-        CBOperationRegistrations[1].PreOperation = CBTdPreOperationCallback;
-        CBOperationRegistrations[1].PostOperation = CBTdPostOperationCallback;
+    DbgPrintEx (
+        DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL,
+        "ObCallbackTest: TdProtectNameCallback: name to protect/filter %ls\n", TdwProtectName
+    );
+
+Exit:
+    DbgPrintEx (
+        DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL,
+        "ObCallbackTest: TdProtectNameCallback: exiting  status 0x%x\n", Status
+    );
+    return Status;
+}
 
 
-        RtlInitUnicodeString (&CBAltitude, L"1000");
+//
+// TdProtectProcessIdCallback
+//
+// Protects a process that is already running.
+//
 
-        CBObRegistration.Version                    = OB_FLT_REGISTRATION_VERSION;
-        CBObRegistration.OperationRegistrationCount = 2;
-        CBObRegistration.Altitude                   = CBAltitude;
-        CBObRegistration.RegistrationContext        = &CBCallbackRegistration;
-        CBObRegistration.OperationRegistration      = CBOperationRegistrations;
+NTSTATUS TdProtectProcessIdCallback (
+    _In_ HANDLE ProcessId
+)
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    PEPROCESS Process = NULL;
 
+    DbgPrintEx (
+        DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL,
+        "ObCallbackTest: TdProtectProcessIdCallback: entering process ID 0x%p\n", (PVOID)ProcessId
+    );
 
-        Status = ObRegisterCallbacks (
-            &CBObRegistration,
-            &pCBRegistrationHandle       // save the registration handle to remove callbacks later
-        );
+    Status = PsLookupProcessByProcessId (ProcessId, &Process);
+    if (!NT_SUCCESS (Status)) {
+        goto Exit;
+    }
 
-        if (!NT_SUCCESS (Status))   {
-            DbgPrintEx (
-                DPFLTR_IHVDRIVER_ID, DPFLTR_ERROR_LEVEL,
-                "ObCallbackTest: installing OB callbacks failed  status 0x%x\n", Status
-            );
-            KeReleaseGuardedMutex (&TdCallbacksMutex); // Release the lock before exit
-            goto Exit;
-        }
-        bCallbacksInstalled = TRUE;
+    KeAcquireGuardedMutex (&TdCallbacksMutex);
+    Status = TdInstallCallbacks ();
+    KeReleaseGuardedMutex (&TdCallbacksMutex);
 
+    if (!NT_SUCCESS (Status)) {
+        goto Exit;
     }
 
+    Status = TdProtectProcessId (ProcessId);
+    if (!NT_SUCCESS (Status)) {
+        goto Exit;
+    }
 
-    KeReleaseGuardedMutex (&TdCallbacksMutex);
+    //
+    // If the process started exiting before it was added, its exit
+    // notification may have missed the table entry, which would then
+    // outlive the process and protect the next one given the same ID.
+    //
 
+    if (PsGetProcessExitStatus (Process) != STATUS_PENDING) {
+        TdUnprotectProcessId (ProcessId);
+        Status = STATUS_PROCESS_IS_TERMINATING;
+        goto Exit;
+    }
 
     DbgPrintEx (
         DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL,
-        "ObCallbackTest: TdProtectNameCallback: name to protect/filter %ls\n", TdwProtectName
+        "ObCallbackTest: TdProtectProcessIdCallback: PROTECTING process %p (ID 0x%p)\n",
+        Process,
+        (PVOID)ProcessId
     );
 
 Exit:
+
+    if (Process != NULL) {
+        ObDereferenceObject (Process);
+    }
+
     DbgPrintEx (
         DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL,
-        "ObCallbackTest: TdProtectNameCallback: exiting  status 0x%x\n", Status
+        "ObCallbackTest: TdProtectProcessIdCallback: exiting  status 0x%x\n", Status
     );
     return Status;
 }
@@ -185,6 +274,9 @@ NTSTATUS TdCheckProcessMatch (
     WCHAR   CommandLineBuffer[NAME_SIZE + 1] = {0};    // force a NULL termination
     USHORT  CommandLineBytes = 0;
 
+    UNREFERENCED_PARAMETER (Process);
+    UNREFERENCED_PARAMETER (ProcessId);
+
     DbgPrintEx (
         DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL,
         "ObCallbackTest: TdCheckProcessMatch: entering\n");
@@ -229,10 +321,6 @@ NTSTATUS TdCheckProcessMatch (
                 "ObCallbackTest: TdCheckProcessMatch: match FOUND\n"
                 );
 
-            // Set the process to watch
-            TdProtectedTargetProcess = Process;
-            TdProtectedTargetProcessId = ProcessId;
-
             Status = STATUS_SUCCESS;
         }
     }
@@ -286,12 +374,10 @@ CBTdPreOperationCallback (
 
     if (PreInfo->ObjectType == *PsProcessType)  {
         //
-        // Ignore requests for processes other than our target process.
+        // Ignore requests for processes other than our target processes.
         //
 
-        // if (TdProtectedTargetProcess != NULL &&
-        //    TdProtectedTargetProcess != PreInfo->Object)
-        if (TdProtectedTargetProcess != PreInfo->Object)
+        if (!TdIsProtectedProcessId (PsGetProcessId ((PEPROCESS)PreInfo->Object)))
         {
             goto Exit;
         }
@@ -317,12 +403,10 @@ CBTdPreOperationCallback (
 
         //
         // Ignore requests for threads belonging to processes other than our
-        // target process.
+        // target processes.
         //
 
-        // if (CallbackRegistration->TargetProcess   != NULL &&
-        //     CallbackRegistration->TargetProcessId != ProcessIdOfTargetThread)
-        if (TdProtectedTargetProcessId != ProcessIdOfTargetThread)  {
+        if (!TdIsProtectedProcessId (ProcessIdOfTargetThread))  {
             goto Exit;
         }
 
@@ -384,9 +468,9 @@ CBTdPreOperationCallback (
 
 
     DbgPrintEx (
-        DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "ObCallbackTest: CBTdPreOperationCallback: PROTECTED process %p (ID 0x%p)\n",
-        TdProtectedTargetProcess,
-        (PVOID)TdProtectedTargetProcessId
+        DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "ObCallbackTest: CBTdPreOperationCallback: PROTECTED %ls %p\n",
+        ObjectTypeName,
+        PreInfo->Object
     );
 
     DbgPrintEx (
@@ -7,7 +7,7 @@
 
 #pragma once
 
-#include <ntddk.h>
+#include <ntifs.h>
 #include <ntstrsafe.h>
 
 
@@ -0,0 +1,307 @@
+/*++
+
+Module Name:
+
+    protect.c
+
+Abstract:
+
+    Table of the processes whose handles are filtered by the Ob callbacks.
+
+    The table is an open addressing hash set of process IDs with linear
+    probing. It is looked up by the pre-operation callback on every process
+    and thread handle create or duplicate in the system, so the lookup
+    takes no lock: it runs under a sequence count and retries if the table
+    changed underneath it. Updates are rare (a protected process starts or
+    exits, or the control app changes the configuration); they are
+    serialized by TdCallbacksMutex and done at DISPATCH_LEVEL so a reader
+    never waits on a preempted writer.
+
+Notice:
+    Use this sample code at your own risk; there is no support from Microsoft for the sample code.
+    In addition, this sample code is licensed to you under the terms of the Microsoft Public License
+    (http://www.microsoft.com/opensource/licenses.mspx)
+
+
+--*/
+
+#include "pch.h"
+#include "tdriver.h"
+
+//
+// The table has TD_PROTECT_TABLE_SIZE slots and holds at most half as
+// many processes, so a probe is short even for IDs that are not in it,
+// which is the common case.
+//
+
+#define TD_PROTECT_TABLE_BITS   8
+#define TD_PROTECT_TABLE_SIZE   (1 << TD_PROTECT_TABLE_BITS)
+#define TD_PROTECT_TABLE_MASK   (TD_PROTECT_TABLE_SIZE - 1)
+
+C_ASSERT (TD_MAX_PROTECTED_PROCESSES <= TD_PROTECT_TABLE_SIZE / 2);
+
+typedef struct _TD_PROTECT_TABLE {
+
+    //
+    // Odd while an update is in progress.
+    //
+
+    volatile LONG Sequence;
+
+    ULONG Count;
+
+    //
+    // Process IDs; NULL marks an empty slot. The System Idle Process,
+    // whose ID is 0, cannot be protected.
+    //
+
+    HANDLE volatile ProcessIds[TD_PROTECT_TABLE_SIZE];
+
+}
+TD_PROTECT_TABLE, *PTD_PROTECT_TABLE;
+
+TD_PROTECT_TABLE TdProtectTable = {0};
+
+
+//
+// TdProtectHash
+//
+// Process IDs are multiples of 4, so the low bits are dropped before the
+// ID is scrambled with a multiplicative hash.
+//
+
+FORCEINLINE
+ULONG TdProtectHash (
+    _In_ HANDLE ProcessId
+)
+{
+    ULONG Key = (ULONG)((ULONG_PTR)ProcessId >> 2);
+
+    return (Key * 0x9E3779B1UL) >> (32 - TD_PROTECT_TABLE_BITS);
+}
+
+//
+// TdProtectFind
+//
+// Returns the slot holding ProcessId, or the empty slot that ends its probe
+// sequence. The table always has empty slots.
+//
+
+ULONG TdProtectFind (
+    _In_ HANDLE ProcessId
+)
+{
+    ULONG Index = TdProtectHash (ProcessId);
+    HANDLE Key;
+
+    for (;;) {
+        Key = ReadPointerNoFence ((PVOID volatile *)&TdProtectTable.ProcessIds[Index]);
+
+        if (Key == ProcessId || Key == NULL) {
+            return Index;
+        }
+
+        Index = (Index + 1) & TD_PROTECT_TABLE_MASK;
+    }
+}
+
+//
+// TdIsProtectedProcessId
+//
+// Lock-free lookup, callable at any IRQL <= DISPATCH_LEVEL.
+//
+
+BOOLEAN TdIsProtectedProcessId (
+    _In_ HANDLE ProcessId
+)
+{
+    LONG Sequence;
+    BOOLEAN Found;
+
+    if (ProcessId == NULL) {
+        return FALSE;
+    }
+
+    for (;;) {
+        Sequence = ReadAcquire (&TdProtectTable.Sequence);
+
+        if ((Sequence & 1) == 0) {
+            Found = (TdProtectTable.ProcessIds[TdProtectFind (ProcessId)] == ProcessId);
+
+            //
+            // Make sure the slots were read before the sequence is read
+            // again. If it didn't change, no update overlapped the lookup.
+            //
+
+            KeMemoryBarrier ();
+
+            if (ReadNoFence (&TdProtectTable.Sequence) == Sequence) {
+                return Found;
+            }
+        }
+
+        YieldProcessor ();
+    }
+}
+
+//
+// TdProtectBeginUpdate / TdProtectEndUpdate
+//
+// Bracket a change to the table. The caller holds TdCallbacksMutex.
+//
+
+FORCEINLINE
+KIRQL TdProtectBeginUpdate ()
+{
+    KIRQL OldIrql;
+
+    KeRaiseIrql (DISPATCH_LEVEL, &OldIrql);
+    InterlockedIncrement (&TdProtectTable.Sequence);
+
+    return OldIrql;
+}
+
+FORCEINLINE
+VOID TdProtectEndUpdate (
+    _In_ KIRQL OldIrql
+)
+{
+    InterlockedIncrement (&TdProtectTable.Sequence);
+    KeLowerIrql (OldIrql);
+}
+
+//
+// TdProtectProcessId
+//
+// Adds a process to the table. Adding a process that is already protected
+// succeeds.
+//
+
+NTSTATUS TdProtectProcessId (
+    _In_ HANDLE ProcessId
+)
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    ULONG Index;
+    KIRQL OldIrql;
+
+    if (ProcessId == NULL) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    KeAcquireGuardedMutex (&TdCallbacksMutex);
+
+    Index = TdProtectFind (ProcessId);
+
+    if (TdProtectTable.ProcessIds[Index] == ProcessId) {
+        goto Exit;
+    }
+
+    if (TdProtectTable.Count >= TD_MAX_PROTECTED_PROCESSES) {
+        DbgPrintEx (
+            DPFLTR_IHVDRIVER_ID, DPFLTR_ERROR_LEVEL,
+            "ObCallbackTest: TdProtectProcessId: table full, process ID 0x%p not protected\n",
+            (PVOID)ProcessId
+        );
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Exit;
+    }
+
+    OldIrql = TdProtectBeginUpdate ();
+
+    TdProtectTable.ProcessIds[Index] = ProcessId;
+    TdProtectTable.Count += 1;
+
+    TdProtectEndUpdate (OldIrql);
+
+Exit:
+
+    KeReleaseGuardedMutex (&TdCallbacksMutex);
+
+    return Status;
+}
+
+//
+// TdUnprotectProcessId
+//
+// Removes a process from the table. Later entries of the same probe
+// sequence are shifted back into the freed slot so no tombstones are
+// needed and lookups of absent IDs stay short.
+//
+
+VOID TdUnprotectProcessId (
+    _In_ HANDLE ProcessId
+)
+{
+    ULONG Hole;
+    ULONG Index;
+    ULONG Home;
+    HANDLE Key;
+    KIRQL OldIrql;
+
+    if (ProcessId == NULL) {
+        return;
+    }
+
+    KeAcquireGuardedMutex (&TdCallbacksMutex);
+
+    Hole = TdProtectFind (ProcessId);
+
+    if (TdProtectTable.ProcessIds[Hole] != ProcessId) {
+        goto Exit;
+    }
+
+    OldIrql = TdProtectBeginUpdate ();
+
+    Index = Hole;
+
+    for (;;) {
+        Index = (Index + 1) & TD_PROTECT_TABLE_MASK;
+        Key = TdProtectTable.ProcessIds[Index];
+
+        if (Key == NULL) {
+            break;
+        }
+
+        //
+        // An entry can move into the hole only if its home slot is not
+        // between the hole and the entry, cyclically.
+        //
+
+        Home = TdProtectHash (Key);
+
+        if (((Index - Home) & TD_PROTECT_TABLE_MASK) >= ((Index - Hole) & TD_PROTECT_TABLE_MASK)) {
+            TdProtectTable.ProcessIds[Hole] = Key;
+            Hole = Index;
+        }
+    }
+
+    TdProtectTable.ProcessIds[Hole] = NULL;
+    TdProtectTable.Count -= 1;
+
+    TdProtectEndUpdate (OldIrql);
+
+Exit:
+
+    KeReleaseGuardedMutex (&TdCallbacksMutex);
+}
+
+//
+// TdUnprotectAllProcesses
+//
+
+VOID TdUnprotectAllProcesses ()
+{
+    KIRQL OldIrql;
+
+    KeAcquireGuardedMutex (&TdCallbacksMutex);
+
+    OldIrql = TdProtectBeginUpdate ();
+
+    RtlZeroMemory ((PVOID)TdProtectTable.ProcessIds, sizeof(TdProtectTable.ProcessIds));
+    TdProtectTable.Count = 0;
+
+    TdProtectEndUpdate (OldIrql);
+
+    KeReleaseGuardedMutex (&TdCallbacksMutex);
+}
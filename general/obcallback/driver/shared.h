@@ -70,6 +70,7 @@ Abstract:
 // #define TD_IOCTL_UNREGISTER_CALLBACK CTL_CODE (FILE_DEVICE_UNKNOWN, (0x800 + 1), METHOD_BUFFERED, FILE_SPECIAL_ACCESS)
 #define TD_IOCTL_PROTECT_NAME_CALLBACK        CTL_CODE (FILE_DEVICE_UNKNOWN, (0x800 + 2), METHOD_BUFFERED, FILE_SPECIAL_ACCESS)
 #define TD_IOCTL_UNPROTECT_CALLBACK           CTL_CODE (FILE_DEVICE_UNKNOWN, (0x800 + 3), METHOD_BUFFERED, FILE_SPECIAL_ACCESS)
+#define TD_IOCTL_PROTECT_PROCESS_ID           CTL_CODE (FILE_DEVICE_UNKNOWN, (0x800 + 4), METHOD_BUFFERED, FILE_SPECIAL_ACCESS)
 
 
 #define TDProtectName_Protect  0            // name of programs to proect and filter out the desiredAccess on Process Open
@@ -93,3 +94,12 @@ typedef struct _TD_UNPROTECT_CALLBACK_INPUT {
     ULONG UnusedParameter;
 }
 TD_UNPROTECT_CALLBACK_INPUT, *PTD_UNPROTECT_CALLBACK_INPUT;
+
+//
+// Structures used by TD_IOCTL_PROTECT_PROCESS_ID
+//
+
+typedef struct _TD_PROTECT_PROCESS_ID_INPUT {
+    ULONG ProcessId;              // running process to protect
+}
+TD_PROTECT_PROCESS_ID_INPUT, *PTD_PROTECT_PROCESS_ID_INPUT;
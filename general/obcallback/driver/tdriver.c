@@ -73,6 +73,10 @@ TdCreateProcessNotifyRoutine2 (
             {
                 Status = TdCheckProcessMatch(CreateInfo->CommandLine, Process, ProcessId);
 
+                if (Status == STATUS_SUCCESS) {
+                    Status = TdProtectProcessId (ProcessId);
+                }
+
                 if (Status == STATUS_SUCCESS) {
                     DbgPrintEx (
                         DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "ObCallbackTest: TdCreateProcessNotifyRoutine2: PROTECTING process %p (ID 0x%p)\n",
@@ -110,6 +114,12 @@ TdCreateProcessNotifyRoutine2 (
             Process,
             (PVOID)ProcessId
         );
+
+        // Stop protecting the process so its ID can be reused. Most processes
+        // are not protected, and for them the lookup takes no lock.
+        if (TdIsProtectedProcessId (ProcessId)) {
+            TdUnprotectProcessId (ProcessId);
+        }
     }
 }
 
@@ -276,6 +286,7 @@ TdDeviceUnload (
     TdbProtectName = FALSE;
     Status = TdDeleteProtectNameCallback();
     TD_ASSERT (Status == STATUS_SUCCESS);
+    TdUnprotectAllProcesses ();
 
     //
     // Delete the link from our device name to a name in the Win32 namespace.
@@ -462,6 +473,7 @@ NTSTATUS TdControlUnprotect (
         }
     TdbProtectName = FALSE;
     TdbRejectName = FALSE;
+    TdUnprotectAllProcesses ();
 
 //Exit:
     DbgPrintEx (
@@ -472,6 +484,44 @@ NTSTATUS TdControlUnprotect (
 }
 
 
+//
+// TdControlProtectProcessId
+//
+
+NTSTATUS TdControlProtectProcessId (
+    IN PDEVICE_OBJECT  DeviceObject,
+    IN PIRP  Irp
+)
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    PIO_STACK_LOCATION IrpStack = NULL;
+    ULONG InputBufferLength = 0;
+    PTD_PROTECT_PROCESS_ID_INPUT pProtectProcessIdInput = NULL;
+
+    UNREFERENCED_PARAMETER (DeviceObject);
+
+    IrpStack = IoGetCurrentIrpStackLocation (Irp);
+    InputBufferLength = IrpStack->Parameters.DeviceIoControl.InputBufferLength;
+
+    if (InputBufferLength < sizeof (TD_PROTECT_PROCESS_ID_INPUT))
+    {
+        Status = STATUS_BUFFER_OVERFLOW;
+        goto Exit;
+    }
+
+    pProtectProcessIdInput = (PTD_PROTECT_PROCESS_ID_INPUT)Irp->AssociatedIrp.SystemBuffer;
+
+    Status = TdProtectProcessIdCallback ((HANDLE)(ULONG_PTR)pProtectProcessIdInput->ProcessId);
+
+Exit:
+    DbgPrintEx (
+        DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL,
+        "ObCallbackTest: TD_IOCTL_PROTECT_PROCESS_ID: Status %x\n", Status);
+
+    return Status;
+}
+
+
 //
 // Function:
 //
@@ -514,6 +564,11 @@ TdDeviceControl (
         Status = TdControlUnprotect (DeviceObject, Irp);
         break;
 
+    case TD_IOCTL_PROTECT_PROCESS_ID:
+
+        Status = TdControlProtectProcessId (DeviceObject, Irp);
+        break;
+
 
     default:
         DbgPrintEx (DPFLTR_IHVDRIVER_ID, DPFLTR_ERROR_LEVEL, "TdDeviceControl: unrecognized ioctl code 0x%x\n", Ioctl);
@@ -24,6 +24,8 @@ Abstract:
 #define TD_CALLBACK_REGISTRATION_TAG  '0bCO' // TD_CALLBACK_REGISTRATION structure.
 #define TD_CALL_CONTEXT_TAG           '1bCO' // TD_CALL_CONTEXT structure.
 
+#define TD_MAX_PROTECTED_PROCESSES    128
+
 
 typedef struct _TD_CALLBACK_PARAMETERS {
     ACCESS_MASK AccessBitsToClear;
@@ -95,6 +97,10 @@ NTSTATUS TdProtectNameCallback(
     _In_ PTD_PROTECTNAME_INPUT pProtectName
 );
 
+NTSTATUS TdProtectProcessIdCallback (
+    _In_ HANDLE ProcessId
+);
+
 NTSTATUS TdCheckProcessMatch (
     _In_ PCUNICODE_STRING pustrCommand,
     _In_ PEPROCESS Process,
@@ -113,6 +119,24 @@ CBTdPostOperationCallback (
     _In_ POB_POST_OPERATION_INFORMATION PostInfo
 );
 
+//
+// Protected process table, see protect.c
+//
+
+BOOLEAN TdIsProtectedProcessId (
+    _In_ HANDLE ProcessId
+);
+
+NTSTATUS TdProtectProcessId (
+    _In_ HANDLE ProcessId
+);
+
+VOID TdUnprotectProcessId (
+    _In_ HANDLE ProcessId
+);
+
+VOID TdUnprotectAllProcesses ();
+
 VOID TdSetCallContext (
     _Inout_ POB_PRE_OPERATION_INFORMATION PreInfo,
     _In_ PTD_CALLBACK_REGISTRATION CallbackRegistration
@@ -113,58 +113,142 @@ Return Value:
 --*/
 {
     PFDO_DATA fdoData = NULL;
+    ULONG     pollPass = 0;
+    BOOLEAN   workPending = FALSE;
 
     TraceEvents(TRACE_LEVEL_VERBOSE, DBG_DPC, "--> NICEvtInterruptDpc\n");
 
     fdoData = FdoGetData(WdfDevice);
 
+    do {
 
-    WdfSpinLockAcquire(fdoData->RcvLock);
+        WdfSpinLockAcquire(fdoData->RcvLock);
 
-    NICHandleRecvInterrupt(fdoData);
+        NICHandleRecvInterrupt(fdoData);
 
 
-    WdfSpinLockRelease(fdoData->RcvLock);
+        WdfSpinLockRelease(fdoData->RcvLock);
 
-    //
-    // Handle send interrupt
-    //
+        //
+        // Handle send interrupt
+        //
 
-    WdfSpinLockAcquire(fdoData->SendLock);
+        WdfSpinLockAcquire(fdoData->SendLock);
 
-    NICHandleSendInterrupt(fdoData);
+        NICHandleSendInterrupt(fdoData);
 
 
-    WdfSpinLockRelease(fdoData->SendLock);
+        WdfSpinLockRelease(fdoData->SendLock);
 
-    //
-    // Check if any queued Sends need to be reprocessed.
-    //
-    NICCheckForQueuedSends(fdoData);
+        //
+        // Check if any queued Sends need to be reprocessed.
+        //
+        NICCheckForQueuedSends(fdoData);
 
-    //
-    // Start the receive unit if it had stopped
-    //
+        //
+        // Start the receive unit if it had stopped
+        //
 
-    WdfSpinLockAcquire(fdoData->RcvLock);
+        WdfSpinLockAcquire(fdoData->RcvLock);
 
-    NICStartRecv(fdoData);
+        NICStartRecv(fdoData);
 
 
-    WdfSpinLockRelease(fdoData->RcvLock);
+        WdfSpinLockRelease(fdoData->RcvLock);
 
-    //
-    // Re-enable the interrupt (disabled in MPIsr)
-    //
-    WdfInterruptSynchronize(
-        WdfInterrupt,
-        NICEnableInterrupt,
-        fdoData);
+        if (fdoData->InterruptPollBudget == 0 ||
+            fdoData->DevicePowerState != PowerDeviceD0) {
+            workPending = FALSE;
+            break;
+        }
+
+        //
+        // The interrupt is still masked, so look at the rings ourselves
+        // for anything that completed while we were busy.
+        //
+        workPending = NICInterruptWorkPending(fdoData);
+
+    } WHILE (workPending && ++pollPass < fdoData->InterruptPollBudget);
+
+    if (workPending) {
+        //
+        // Out of budget with the rings still busy. Leave the interrupt
+        // masked and poll again from a fresh DPC so that other DPCs queued
+        // on this processor get to run in between.
+        //
+        fdoData->InterruptPollYields++;
+        WdfInterruptQueueDpcForIsr(WdfInterrupt);
+    }
+    else {
+        //
+        // Re-enable the interrupt (disabled in MPIsr). Anything that
+        // completes from here on raises a new interrupt.
+        //
+        WdfInterruptSynchronize(
+            WdfInterrupt,
+            NICEnableInterrupt,
+            fdoData);
+    }
 
     TraceEvents(TRACE_LEVEL_VERBOSE, DBG_DPC, "<-- NICEvtInterruptDpc\n");
 
 }
 
+BOOLEAN
+NICInterruptWorkPending(
+    IN  PFDO_DATA  FdoData
+    )
+/*++
+
+Routine Description:
+
+    Used by NICEvtInterruptDpc while polling with the interrupt masked.
+    Checks the head of the receive and send lists for a completed RFD or
+    TCB that has not been processed yet.
+
+    Assumption: This function is called without the Rcv and Send
+    SPINLOCKs held.
+
+Arguments:
+
+    FdoData     Pointer to our FdoData
+
+Return Value:
+
+    TRUE if either ring has completed work waiting.
+
+--*/
+{
+    BOOLEAN workPending = FALSE;
+    PMP_RFD pMpRfd;
+
+    WdfSpinLockAcquire(FdoData->RcvLock);
+
+    if (!IsListEmpty(&FdoData->RecvList)) {
+        pMpRfd = (PMP_RFD)GetListHeadEntry(&FdoData->RecvList);
+        if (NIC_RFD_STATUS_COMPLETED(NIC_RFD_GET_STATUS(pMpRfd->HwRfd))) {
+            workPending = TRUE;
+        }
+    }
+
+    WdfSpinLockRelease(FdoData->RcvLock);
+
+    if (workPending) {
+        return TRUE;
+    }
+
+    WdfSpinLockAcquire(FdoData->SendLock);
+
+    if (FdoData->nBusySend > 0 &&
+        (FdoData->CurrSendHead->HwTcb->TxCbHeader.CbStatus & CB_STATUS_COMPLETE)) {
+        workPending = TRUE;
+    }
+
+    WdfSpinLockRelease(FdoData->SendLock);
+
+    return workPending;
+}
+
 NTSTATUS
 NICEvtInterruptEnable(
     IN WDFINTERRUPT  Interrupt,
@@ -132,6 +132,8 @@ typedef PCSR_STRUC                      PHW_CSR;
 #define NIC_RFD_STATUS_SUCCESS(_Status) ((_Status) & RFD_STATUS_OK)
 #define NIC_RFD_GET_PACKET_SIZE(_HwRfd) (((_HwRfd)->RfdActualCount) & RFD_ACT_COUNT_MASK)
 #define NIC_RFD_VALID_ACTUALCOUNT(_HwRfd) ((((_HwRfd)->RfdActualCount) & (RFD_EOF_BIT | RFD_F_BIT)) == (RFD_EOF_BIT | RFD_F_BIT))
+#define NIC_RBD_GET_PACKET_SIZE(_HwRbd) (((_HwRbd)->RbdActualCount) & RBD_ACT_COUNT_MASK)
+#define NIC_RBD_VALID_ACTUALCOUNT(_HwRbd) ((((_HwRbd)->RbdActualCount) & (RBD_EOF_BIT | RBD_F_BIT)) == (RBD_EOF_BIT | RBD_F_BIT))
 
 #define ListNext(_pL)                       (_pL)->Flink
 
@@ -159,6 +161,7 @@ typedef PCSR_STRUC                      PHW_CSR;
 #define fMP_RFD_ALLOC_PEND                     0x00000002
 #define fMP_RFD_RECV_READY                     0x00000004
 #define fMP_RFD_RESOURCES                      0x00000008
+#define fMP_RFD_DIRECT                         0x00000010  // armed with a read request buffer
 
 // MP_ADAPTER flags
 #define fMP_ADAPTER_SCATTER_GATHER             0x00000001  // obsolete
@@ -335,6 +338,17 @@ typedef struct _MP_RFD
     ULONG                   Flags;
     ULONG                   PacketSize;       // total size of receive frame
     WDFMEMORY               LookasideMemoryHdl;
+
+    //
+    // DirectReceive only. The RFD is used in flexible mode and carries no
+    // data itself; its RBD points at the read request buffer.
+    //
+    PRBD_STRUC              HwRbd;            // RBD in the unused data area
+    ULONG                   HwRbdPhys;
+    WDFREQUEST              DirectRequest;
+    WDFDMATRANSACTION       DmaTransaction;
+    ULONG                   DirectBufferLa;   // logical address of the request buffer
+    ULONG                   DirectBufferLength;
 } MP_RFD, *PMP_RFD;
 
 //--------------------------------------
@@ -493,8 +507,13 @@ EVT_WDF_DEVICE_D0_ENTRY_POST_INTERRUPTS_ENABLED NICEvtDeviceD0EntryPostInterrupt
 EVT_WDF_DEVICE_D0_EXIT_PRE_INTERRUPTS_DISABLED NICEvtDeviceD0ExitPreInterruptsDisabled;
 
 EVT_WDF_IO_QUEUE_IO_WRITE PciDrvEvtIoWrite;
+EVT_WDF_IO_QUEUE_IO_READ PciDrvEvtIoRead;
+EVT_WDF_IO_QUEUE_IO_STOP PciDrvEvtIoStopRead;
 
 EVT_WDF_PROGRAM_DMA NICEvtProgramDmaFunction;
+EVT_WDF_PROGRAM_DMA NICEvtProgramRecvDmaFunction;
+
+EVT_WDF_REQUEST_CANCEL NICEvtDirectReadCancel;
 
 EVT_WDF_TIMER NICWatchDogEvtTimerFunc;
 
@@ -610,6 +629,17 @@ NICSendPacket(
     IN  PMP_TCB       pMpTcb,
     IN  PSCATTER_GATHER_LIST   ScatterGather);
 
+BOOLEAN
+NICInterruptWorkPending(
+    IN  PFDO_DATA  FdoData
+    );
+
+_Requires_lock_held_(FdoData->SendLock)
+NTSTATUS
+NICFlushSends(
+    IN  PFDO_DATA  FdoData
+    );
+
 NTSTATUS
 NICStartSend(
     IN  PFDO_DATA     FdoData,
@@ -679,6 +709,19 @@ NICServiceReadIrps(
     ULONG PacketArrayCount
     );
 
+_IRQL_requires_same_
+_IRQL_requires_(DISPATCH_LEVEL)
+_Requires_lock_held_(FdoData->RcvLock)
+VOID
+NICHandleDirectRecvInterrupt(
+    IN  PFDO_DATA  FdoData
+    );
+
+VOID
+NICIndicateMediaConnected(
+    IN  PFDO_DATA  FdoData
+    );
+
 BOOLEAN
 NICCheckForHang(
     IN  PFDO_DATA     FdoData
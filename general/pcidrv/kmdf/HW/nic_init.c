@@ -122,6 +122,7 @@ Return Value:
     //
     InitializeListHead(&FdoData->PoMgmt.PatternList);
     InitializeListHead(&FdoData->RecvList);
+    InitializeListHead(&FdoData->DirectRfdList);
 
     //
     // This a global lock, to synchonize access to device context.
@@ -252,9 +253,38 @@ Return Value:
         return status;
     }
 
+    if (FdoData->DirectReceive) {
+        //
+        // In DirectReceive mode read requests are not copied into from the
+        // recv interrupt handler. Instead each one is mapped for DMA as soon
+        // as it arrives and its buffer is handed to the receive unit, so
+        // they go to a parallel queue. EvtIoStop lets us take the buffers
+        // back from the hardware when the device leaves D0.
+        //
+        WDF_IO_QUEUE_CONFIG_INIT(
+            &ioQueueConfig,
+            WdfIoQueueDispatchParallel
+            );
+
+        ioQueueConfig.EvtIoRead = PciDrvEvtIoRead;
+        ioQueueConfig.EvtIoStop = PciDrvEvtIoStopRead;
+
+        status = WdfIoQueueCreate (
+                       FdoData->WdfDevice,
+                       &ioQueueConfig,
+                       WDF_NO_OBJECT_ATTRIBUTES,
+                       &FdoData->ReadQueue
+                       );
+
+        if(!NT_SUCCESS (status)){
+            TraceEvents(TRACE_LEVEL_ERROR, DBG_INIT, "Error Creating direct read Queue 0x%x\n", status);
+            return status;
+        }
+    }
+
     status = WdfDeviceConfigureRequestDispatching(
                     FdoData->WdfDevice,
-                    FdoData->PendingReadQueue,
+                    FdoData->DirectReceive ? FdoData->ReadQueue : FdoData->PendingReadQueue,
                     WdfRequestTypeRead);
 
     if(!NT_SUCCESS (status)){
@@ -1206,7 +1236,7 @@ Return Value:
     ASSERT(FdoData->nBusySend == 0);
     ASSERT(FdoData->nWaitSend == 0);
 
-    ASSERT(FdoData->nReadyRecv == FdoData->CurrNumRfd);
+    ASSERT(FdoData->nReadyRecv + FdoData->nIdleDirectRfd == FdoData->CurrNumRfd);
 
     while (!IsListEmpty(&FdoData->RecvList))
     {
@@ -1217,6 +1247,16 @@ Return Value:
         NICFreeRfd(FdoData, pMpRfd);
     }
 
+    while (!IsListEmpty(&FdoData->DirectRfdList))
+    {
+        pMpRfd = (PMP_RFD)RemoveHeadList(&FdoData->DirectRfdList);
+        FdoData->nIdleDirectRfd--;
+
+        pMpRfd->DeleteCommonBuffer = FALSE;
+
+        NICFreeRfd(FdoData, pMpRfd);
+    }
+
     FdoData->WdfSendCommonBuffer = NULL;
     FdoData->HwSendMemAllocVa = NULL;
 
@@ -1273,6 +1313,7 @@ Return Value:
 
     FdoData->TransmitIdle = TRUE;
     FdoData->ResumeWait = TRUE;
+    FdoData->SendBatchHead = NULL;
 
     // Setup the initial pointers to the SW and HW TCB data space
     pMpTcb = (PMP_TCB) FdoData->MpTcbMem;
@@ -1433,10 +1474,19 @@ Return Value:
             continue;
         }
         //
-        // Add this RFD to the RecvList
+        // Add this RFD to the RecvList. In DirectReceive mode it only goes
+        // on the RecvList once a read request has been attached to it.
         //
         FdoData->CurrNumRfd++;
-        NICReturnRFD(FdoData, pMpRfd);
+        if (FdoData->DirectReceive)
+        {
+            InsertTailList(&FdoData->DirectRfdList, &pMpRfd->List);
+            FdoData->nIdleDirectRfd++;
+        }
+        else
+        {
+            NICReturnRFD(FdoData, pMpRfd);
+        }
     }
 
     if (FdoData->CurrNumRfd > NIC_MIN_RFDS)
@@ -1510,6 +1560,16 @@ Return Value:
         pHwRfd->RfdRbdPointer = DRIVER_NULL;
         pHwRfd->RfdSize = NIC_MAX_PACKET_SIZE;
 
+        //
+        // A flexible mode RFD (DirectReceive) leaves its data area unused,
+        // so that is where its RBD goes.
+        //
+        pMpRfd->HwRbd = (PRBD_STRUC)DATA_ALIGN(&pHwRfd->RfdBuffer);
+        pMpRfd->HwRbdPhys = pMpRfd->HwRfdPhys +
+                            (ULONG)BYTES_SHIFT(pMpRfd->HwRbd, pHwRfd);
+        pMpRfd->DirectRequest = NULL;
+        pMpRfd->DmaTransaction = NULL;
+
     } WHILE (FALSE);
 
 
@@ -2327,6 +2387,31 @@ NICGetDeviceInfSettings(
     FdoData->NumBuffers = min(FdoData->NumBuffers, 32);
     FdoData->NumBuffers = max(FdoData->NumBuffers, 1);
 
+    //
+    // Receive frames straight into the buffers of pended read requests
+    // instead of copying them out of the RFDs. Every outstanding read holds
+    // one RFD, so NumRfd also bounds the reads the device will accept.
+    //
+    if(!PciDrvReadRegistryValue(FdoData,
+                                L"DirectReceive",
+                                &FdoData->DirectReceive)){
+        FdoData->DirectReceive = 0;
+    }
+
+    //
+    // Number of times NICEvtInterruptDpc polls the rings before it gives
+    // the processor up. As long as completions keep showing up the
+    // interrupt stays masked and the DPC requeues itself instead. Zero
+    // keeps the one-interrupt-one-DPC behavior.
+    //
+    if(!PciDrvReadRegistryValue(FdoData,
+                                L"InterruptPollBudget",
+                                &FdoData->InterruptPollBudget)){
+        FdoData->InterruptPollBudget = 0;
+    }
+
+    FdoData->InterruptPollBudget = min(FdoData->InterruptPollBudget, 64);
+
     //
     // Get the Link Speed & Duplex.
     //
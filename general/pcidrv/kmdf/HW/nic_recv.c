@@ -25,6 +25,52 @@ Environment:
 #include "nic_recv.tmh"
 #endif
 
+VOID
+NICIndicateMediaConnected(
+    IN  PFDO_DATA  FdoData
+    )
+/*++
+Routine Description:
+
+    If we have a Recv interrupt and have reported a media disconnect status
+    it's time to indicate the new status.
+
+    Assumption: This function is called without the Rcv SPINLOCK held.
+
+Arguments:
+
+    FdoData     Pointer to our FdoData
+
+Return Value:
+
+    None
+
+--*/
+{
+    WdfSpinLockAcquire(FdoData->Lock);
+
+    if (Disconnected == FdoData->MediaState)
+    {
+        TraceEvents(TRACE_LEVEL_WARNING, DBG_READ, "Media state changed to Connected\n");
+
+        MP_CLEAR_FLAG(FdoData, fMP_ADAPTER_NO_CABLE);
+
+        FdoData->MediaState = Connected;
+
+
+        WdfSpinLockRelease(FdoData->Lock);
+        //
+        // Indicate the media event
+        //
+        NICServiceIndicateStatusIrp(FdoData);
+    }
+
+    else
+    {
+
+        WdfSpinLockRelease(FdoData->Lock);
+    }
+}
 
 _IRQL_requires_same_
 _IRQL_requires_(DISPATCH_LEVEL)
@@ -67,6 +113,12 @@ Return Value:
     BOOLEAN         bAllocNewRfd = FALSE;
     USHORT          PacketStatus;
 
+    if (FdoData->DirectReceive)
+    {
+        NICHandleDirectRecvInterrupt(FdoData);
+        return;
+    }
+
     TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ, "---> NICHandleRecvInterrupt\n");
 
     ASSERT(FdoData->nReadyRecv >= NIC_MIN_RFDS);
@@ -202,34 +254,7 @@ Return Value:
 
         WdfSpinLockRelease(FdoData->RcvLock);
 
-        WdfSpinLockAcquire(FdoData->Lock);
-        //
-        // if we have a Recv interrupt and have reported a media disconnect status
-        // time to indicate the new status
-        //
-
-        if (Disconnected == FdoData->MediaState)
-        {
-            TraceEvents(TRACE_LEVEL_WARNING, DBG_READ, "Media state changed to Connected\n");
-
-            MP_CLEAR_FLAG(FdoData, fMP_ADAPTER_NO_CABLE);
-
-            FdoData->MediaState = Connected;
-
-
-            WdfSpinLockRelease(FdoData->Lock);
-            //
-            // Indicate the media event
-            //
-            NICServiceIndicateStatusIrp(FdoData);
-        }
-
-        else
-        {
-
-            WdfSpinLockRelease(FdoData->Lock);
-        }
-
+        NICIndicateMediaConnected(FdoData);
 
         NICServiceReadIrps(
             FdoData,
@@ -391,6 +416,16 @@ Return Value:
         return STATUS_SUCCESS;
     }
 
+    //
+    // In DirectReceive mode there is nothing to receive into until a read
+    // request comes in. NICEvtProgramRecvDmaFunction starts us again.
+    //
+    if (FdoData->DirectReceive && IsListEmpty(&FdoData->RecvList))
+    {
+        TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ, "No read buffers posted\n");
+        return STATUS_SUCCESS;
+    }
+
     TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ, "Re-start receive unit...\n");
     ASSERT(!IsListEmpty(&FdoData->RecvList));
 
@@ -405,6 +440,12 @@ Return Value:
     if (NIC_RFD_GET_STATUS(pMpRfd->HwRfd))
     {
         NICHandleRecvInterrupt(FdoData);
+
+        if (FdoData->DirectReceive && IsListEmpty(&FdoData->RecvList))
+        {
+            return STATUS_SUCCESS;
+        }
+
         ASSERT(!IsListEmpty(&FdoData->RecvList));
 
         //
@@ -491,6 +532,11 @@ Return Value:
         pHwRfd = pMpRfd->HwRfd;
         pHwRfd->RfdCbHeader.CbStatus = 0;
 
+        if (MP_TEST_FLAG(pMpRfd, fMP_RFD_DIRECT))
+        {
+            pMpRfd->HwRbd->RbdActualCount = 0;
+        }
+
         pMpRfd = (PMP_RFD)GetListFLink(&pMpRfd->List);
     }
 
@@ -628,3 +674,657 @@ Return Value:
 
 
 
+
+//
+// DirectReceive
+//
+// Each read request is mapped for DMA when it arrives and its buffer is
+// described by the RBD of an otherwise idle RFD, which is then set to
+// flexible mode and appended to the receive list. The receive unit writes
+// the frame straight into the request buffer and the request is completed
+// from the DPC along with every other frame that landed in the same pass.
+// A frame must fit in one RBD, otherwise its tail would spill into the
+// buffer that belongs to the next request.
+//
+
+VOID
+PciDrvEvtIoRead(
+    IN WDFQUEUE         Queue,
+    IN WDFREQUEST       Request,
+    IN size_t           Length
+    )
+/*++
+
+Routine Description:
+
+    Called by the framework for every read request when DirectReceive is
+    set. Get the scatter-gather list for the request buffer and post it
+    to the receive unit.
+
+Arguments:
+
+    Queue - Handle to the framework queue object that is associated
+            with the I/O request.
+    Request - Handle to a framework request object.
+
+    Length - Length of the IO operation
+
+Return Value:
+
+--*/
+{
+    NTSTATUS            status;
+    PFDO_DATA           FdoData;
+    WDFDMATRANSACTION   dmaTransaction = NULL;
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ,
+                "--> PciDrvEvtIoRead Request %p\n", Request);
+
+    FdoData = FdoGetData(WdfIoQueueGetDevice(Queue));
+
+    do {
+        if (Length < NIC_MAX_PACKET_SIZE)
+        {
+            status = STATUS_BUFFER_TOO_SMALL;
+            break;
+        }
+
+        status = WdfDmaTransactionCreate( FdoData->WdfDmaEnabler,
+                                          WDF_NO_OBJECT_ATTRIBUTES,
+                                          &dmaTransaction );
+
+        if(!NT_SUCCESS(status)) {
+            TraceEvents(TRACE_LEVEL_ERROR, DBG_READ,
+                        "WdfDmaTransactionCreate failed %X\n", status);
+            dmaTransaction = NULL;
+            break;
+        }
+
+        status = WdfDmaTransactionInitializeUsingRequest(
+                                     dmaTransaction,
+                                     Request,
+                                     NICEvtProgramRecvDmaFunction,
+                                     WdfDmaDirectionReadFromDevice );
+
+        if(!NT_SUCCESS(status)) {
+            TraceEvents(TRACE_LEVEL_ERROR, DBG_READ,
+                       "WdfDmaTransactionInitalizeUsingRequest failed %X\n",
+                       status);
+            break;
+        }
+
+        //
+        // NICEvtProgramRecvDmaFunction owns the request from here on.
+        //
+        status = WdfDmaTransactionExecute( dmaTransaction,
+                                           dmaTransaction );
+
+        if(!NT_SUCCESS(status)) {
+            TraceEvents(TRACE_LEVEL_ERROR, DBG_READ,
+                            "WdfDmaTransactionExecute failed %X\n", status);
+            break;
+        }
+
+    } WHILE (FALSE);
+
+    if(!NT_SUCCESS(status)){
+
+        if(dmaTransaction) {
+            WdfObjectDelete( dmaTransaction );
+        }
+
+        WdfRequestCompleteWithInformation(Request, status, 0);
+    }
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ,
+                "<-- PciDrvEvtIoRead %X\n", status);
+}
+
+_Requires_lock_held_(FdoData->RcvLock)
+VOID
+NICArmDirectRfd(
+    IN  PFDO_DATA   FdoData,
+    IN  PMP_RFD     pMpRfd
+    )
+/*++
+Routine Description:
+
+    Point the RFD's RBD at its request buffer and append both to the tail
+    of the receive chain, the same way NICReturnRFD recycles a RFD.
+
+    Assumption: This function is called with the Rcv SPINLOCK held.
+
+Arguments:
+
+    FdoData     Pointer to our FdoData
+    pMpRfd      Pointer to the RFD, with DirectRequest and DmaTransaction set
+
+Return Value:
+
+    None
+
+--*/
+{
+    PMP_RFD     pLastMpRfd;
+    PHW_RFD     pHwRfd = pMpRfd->HwRfd;
+    PRBD_STRUC  pHwRbd = pMpRfd->HwRbd;
+
+    MP_SET_FLAG(pMpRfd, fMP_RFD_DIRECT);
+
+    //
+    // HW_SPECIFIC_START
+    //
+    pHwRbd->RbdActualCount = 0;
+    pHwRbd->RbdLinkAddress = DRIVER_NULL;
+    pHwRbd->RbdRcbAddress = pMpRfd->DirectBufferLa;
+    pHwRbd->RbdSize = (USHORT)(pMpRfd->DirectBufferLength | RBD_EL_BIT);
+
+    //
+    // The RBD pointer is only used by the receive unit when this RFD
+    // is at the head of the list at RU start. Keep it valid in every
+    // RFD so that any of them can be the one we restart from.
+    //
+    pHwRfd->RfdCbHeader.CbStatus = 0;
+    pHwRfd->RfdActualCount = 0;
+    pHwRfd->RfdSize = 0;
+    pHwRfd->RfdRbdPointer = pMpRfd->HwRbdPhys;
+    pHwRfd->RfdCbHeader.CbCommand = (RFD_EL_BIT | RFD_SF_BIT);
+    pHwRfd->RfdCbHeader.CbLinkPointer = DRIVER_NULL;
+
+    //
+    // Append this RFD to the RFD chain and its RBD to the RBD chain
+    //
+    if (!IsListEmpty(&FdoData->RecvList))
+    {
+        pLastMpRfd = (PMP_RFD)GetListTailEntry(&FdoData->RecvList);
+
+        pLastMpRfd->HwRbd->RbdLinkAddress = pMpRfd->HwRbdPhys;
+        pLastMpRfd->HwRbd->RbdSize = (USHORT)pLastMpRfd->DirectBufferLength;
+
+        pLastMpRfd->HwRfd->RfdCbHeader.CbLinkPointer = pMpRfd->HwRfdPhys;
+        pLastMpRfd->HwRfd->RfdCbHeader.CbCommand = RFD_SF_BIT;
+    }
+
+    //
+    // HW_SPECIFIC_END
+    //
+
+    InsertTailList(&FdoData->RecvList, (PLIST_ENTRY)pMpRfd);
+    FdoData->nReadyRecv++;
+    ASSERT(FdoData->nReadyRecv <= FdoData->CurrNumRfd);
+}
+
+_Requires_lock_held_(FdoData->RcvLock)
+VOID
+NICRelinkDirectRfds(
+    IN  PFDO_DATA   FdoData
+    )
+/*++
+Routine Description:
+
+    Rebuild the RFD and RBD chains from the receive list after a RFD has
+    been taken out of the middle of it. The receive unit must be idle.
+
+    Assumption: This function is called with the Rcv SPINLOCK held.
+
+Arguments:
+
+    FdoData     Pointer to our FdoData
+
+Return Value:
+
+    None
+
+--*/
+{
+    PLIST_ENTRY pEntry;
+    PMP_RFD     pMpRfd;
+    PMP_RFD     pNextMpRfd;
+
+    for (pEntry = GetListHeadEntry(&FdoData->RecvList);
+         pEntry != &FdoData->RecvList;
+         pEntry = GetListFLink(pEntry))
+    {
+        pMpRfd = (PMP_RFD)pEntry;
+
+        if (GetListFLink(pEntry) == &FdoData->RecvList)
+        {
+            pMpRfd->HwRfd->RfdCbHeader.CbLinkPointer = DRIVER_NULL;
+            pMpRfd->HwRfd->RfdCbHeader.CbCommand = (RFD_EL_BIT | RFD_SF_BIT);
+            pMpRfd->HwRbd->RbdLinkAddress = DRIVER_NULL;
+            pMpRfd->HwRbd->RbdSize = (USHORT)(pMpRfd->DirectBufferLength | RBD_EL_BIT);
+        }
+        else
+        {
+            pNextMpRfd = (PMP_RFD)GetListFLink(pEntry);
+
+            pMpRfd->HwRfd->RfdCbHeader.CbLinkPointer = pNextMpRfd->HwRfdPhys;
+            pMpRfd->HwRfd->RfdCbHeader.CbCommand = RFD_SF_BIT;
+            pMpRfd->HwRbd->RbdLinkAddress = pNextMpRfd->HwRbdPhys;
+            pMpRfd->HwRbd->RbdSize = (USHORT)pMpRfd->DirectBufferLength;
+        }
+    }
+}
+
+_Requires_lock_held_(FdoData->RcvLock)
+PMP_RFD
+NICFindDirectRfd(
+    IN  PFDO_DATA   FdoData,
+    IN  WDFREQUEST  Request
+    )
+{
+    PLIST_ENTRY pEntry;
+
+    for (pEntry = GetListHeadEntry(&FdoData->RecvList);
+         pEntry != &FdoData->RecvList;
+         pEntry = GetListFLink(pEntry))
+    {
+        if (((PMP_RFD)pEntry)->DirectRequest == Request)
+        {
+            return (PMP_RFD)pEntry;
+        }
+    }
+
+    return NULL;
+}
+
+_Requires_lock_held_(FdoData->RcvLock)
+VOID
+NICDetachDirectRfd(
+    IN  PFDO_DATA   FdoData,
+    IN  PMP_RFD     pMpRfd
+    )
+/*++
+Routine Description:
+
+    Take an armed RFD back from the hardware before its request is
+    completed or requeued without data. The receive unit is stopped
+    so that it cannot be writing into the buffer while we unlink it,
+    and restarted on the remaining RFDs.
+
+    Assumption: This function is called with the Rcv SPINLOCK held.
+
+Arguments:
+
+    FdoData     Pointer to our FdoData
+    pMpRfd      Pointer to an armed RFD on the RecvList
+
+Return Value:
+
+    None
+
+--*/
+{
+    NTSTATUS    status;
+
+    if (FdoData->DevicePowerState == PowerDeviceD0 &&
+        (FdoData->CSRAddress->ScbStatus & SCB_RUS_MASK) != SCB_RUS_IDLE)
+    {
+        (VOID) D100IssueScbCommand(FdoData, SCB_RUC_ABORT, TRUE);
+    }
+
+    RemoveEntryList((PLIST_ENTRY)pMpRfd);
+    FdoData->nReadyRecv--;
+
+    MP_CLEAR_FLAG(pMpRfd, fMP_RFD_DIRECT);
+
+    (VOID) WdfDmaTransactionDmaCompletedFinal(pMpRfd->DmaTransaction, 0, &status);
+    WdfObjectDelete(pMpRfd->DmaTransaction);
+
+    pMpRfd->DmaTransaction = NULL;
+    pMpRfd->DirectRequest = NULL;
+
+    InsertTailList(&FdoData->DirectRfdList, &pMpRfd->List);
+    FdoData->nIdleDirectRfd++;
+
+    NICRelinkDirectRfds(FdoData);
+
+    NICStartRecv(FdoData);
+}
+
+BOOLEAN
+NICEvtProgramRecvDmaFunction(
+    IN  WDFDMATRANSACTION       Transaction,
+    IN  WDFDEVICE               Device,
+    IN  PVOID                   Context,
+    IN  WDF_DMA_DIRECTION       Direction,
+    IN  PSCATTER_GATHER_LIST    ScatterGather
+    )
+/*++
+
+Routine Description:
+
+    Attach the mapped request buffer to an idle RFD and give it to the
+    receive unit.
+
+Arguments:
+
+Return Value:
+
+--*/
+{
+    PFDO_DATA           fdoData;
+    WDFREQUEST          request;
+    NTSTATUS            status;
+    PMP_RFD             pMpRfd;
+
+    UNREFERENCED_PARAMETER( Context );
+    UNREFERENCED_PARAMETER( Direction );
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ,
+                "--> NICEvtProgramRecvDmaFunction\n");
+
+    fdoData = FdoGetData(Device);
+    request = WdfDmaTransactionGetRequest(Transaction);
+
+    WdfSpinLockAcquire(fdoData->RcvLock);
+
+    if (ScatterGather->NumberOfElements != 1)
+    {
+        //
+        // The buffer is not physically contiguous; a frame would end up
+        // split across two RBDs. Callers should use page aligned buffers.
+        //
+        status = STATUS_INVALID_USER_BUFFER;
+    }
+    else if (IsListEmpty(&fdoData->DirectRfdList))
+    {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+    }
+    else
+    {
+        status = WdfRequestMarkCancelableEx(request, NICEvtDirectReadCancel);
+    }
+
+    if (NT_SUCCESS(status))
+    {
+        pMpRfd = (PMP_RFD)RemoveHeadList(&fdoData->DirectRfdList);
+        fdoData->nIdleDirectRfd--;
+
+        pMpRfd->DirectRequest = request;
+        pMpRfd->DmaTransaction = Transaction;
+        pMpRfd->DirectBufferLa = ScatterGather->Elements[0].Address.LowPart;
+        pMpRfd->DirectBufferLength = min(ScatterGather->Elements[0].Length,
+                                         SIZE_FIELD_MASK);
+
+        NICArmDirectRfd(fdoData, pMpRfd);
+
+        //
+        // Start the receive unit if it ran out of buffers
+        //
+        NICStartRecv(fdoData);
+    }
+
+    WdfSpinLockRelease(fdoData->RcvLock);
+
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_READ,
+                    "<-- NICEvtProgramRecvDmaFunction returning %!STATUS!\n",
+                    status);
+        //
+        // Must abort the transaction before deleting.
+        //
+        (VOID) WdfDmaTransactionDmaCompletedFinal(Transaction, 0, &status);
+        WdfObjectDelete( Transaction );
+
+        WdfRequestCompleteWithInformation(request, status, 0);
+        return FALSE;
+    }
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ,
+                "<-- NICEvtProgramRecvDmaFunction\n");
+
+    return TRUE;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(DISPATCH_LEVEL)
+_Requires_lock_held_(FdoData->RcvLock)
+VOID
+NICHandleDirectRecvInterrupt(
+    IN  PFDO_DATA  FdoData
+    )
+/*++
+Routine Description:
+
+    DirectReceive counterpart of NICHandleRecvInterrupt. The frames are
+    already in the request buffers; finish the DMA transactions and
+    complete every request that got a frame in this pass at once.
+
+    Assumption: This function is called with the Rcv SPINLOCK held.
+
+Arguments:
+
+    FdoData     Pointer to our FdoData
+
+Return Value:
+
+    None
+
+--*/
+{
+    PMP_RFD         pMpRfd;
+    PHW_RFD         pHwRfd;
+    PRBD_STRUC      pHwRbd;
+
+    PMP_RFD         PacketArray[NIC_DEF_RFDS];
+    UINT            PacketArrayCount;
+    UINT            Index;
+    UINT            LoopIndex = 0;
+    UINT            LoopCount = NIC_MAX_RFDS / NIC_DEF_RFDS + 1;    // avoid staying here too long
+
+    BOOLEAN         bContinue = TRUE;
+    USHORT          PacketStatus;
+    NTSTATUS        status;
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ, "---> NICHandleDirectRecvInterrupt\n");
+
+    while (LoopIndex++ < LoopCount && bContinue)
+    {
+        PacketArrayCount = 0;
+
+        while (PacketArrayCount < NIC_DEF_RFDS)
+        {
+            if (IsListEmpty(&FdoData->RecvList))
+            {
+                ASSERT(FdoData->nReadyRecv == 0);
+                bContinue = FALSE;
+                break;
+            }
+
+            pMpRfd = (PMP_RFD)GetListHeadEntry(&FdoData->RecvList);
+            pHwRfd = pMpRfd->HwRfd;
+            pHwRbd = pMpRfd->HwRbd;
+
+            //
+            // Is this packet completed? In flexible mode the actual count
+            // is reported in the RBD rather than the RFD.
+            //
+            PacketStatus = NIC_RFD_GET_STATUS(pHwRfd);
+            if (!NIC_RFD_STATUS_COMPLETED(PacketStatus) ||
+                !NIC_RBD_VALID_ACTUALCOUNT(pHwRbd))
+            {
+                bContinue = FALSE;
+                break;
+            }
+
+            RemoveEntryList((PLIST_ENTRY)pMpRfd);
+            FdoData->nReadyRecv--;
+
+            //
+            // A bad packet, or one we shouldn't be receiving yet: give the
+            // same buffer straight back to the receive unit.
+            //
+            if (!NIC_RFD_STATUS_SUCCESS(PacketStatus) ||
+                !FdoData->PacketFilter ||
+                FdoData->DevicePowerState != PowerDeviceD0)
+            {
+                TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ,
+                            "Dropping packet, status = %x\n", PacketStatus);
+                NICArmDirectRfd(FdoData, pMpRfd);
+                continue;
+            }
+
+            MP_CLEAR_FLAG(pMpRfd, fMP_RFD_DIRECT);
+
+            pMpRfd->PacketSize = NIC_RBD_GET_PACKET_SIZE(pHwRbd);
+
+            (VOID) WdfDmaTransactionDmaCompletedFinal(pMpRfd->DmaTransaction,
+                                                      pMpRfd->PacketSize,
+                                                      &status);
+            WdfObjectDelete(pMpRfd->DmaTransaction);
+            pMpRfd->DmaTransaction = NULL;
+
+            //
+            // If the request is being canceled, NICEvtDirectReadCancel
+            // will not find it on the RecvList and completes it.
+            //
+            if (WdfRequestUnmarkCancelable(pMpRfd->DirectRequest) == STATUS_CANCELLED)
+            {
+                pMpRfd->DirectRequest = NULL;
+            }
+
+            PacketArray[PacketArrayCount] = pMpRfd;
+            PacketArrayCount++;
+        }
+
+        if (PacketArrayCount == 0)
+        {
+            break;
+        }
+
+        WdfSpinLockRelease(FdoData->RcvLock);
+
+        NICIndicateMediaConnected(FdoData);
+
+        for (Index = 0; Index < PacketArrayCount; Index++)
+        {
+            pMpRfd = PacketArray[Index];
+
+            if (pMpRfd->DirectRequest)
+            {
+                WdfRequestCompleteWithInformation(pMpRfd->DirectRequest,
+                                                  STATUS_SUCCESS,
+                                                  pMpRfd->PacketSize);
+                FdoData->BytesReceived += pMpRfd->PacketSize;
+            }
+        }
+
+        WdfSpinLockAcquire(FdoData->RcvLock);
+
+        //
+        // The RFDs wait for the next read requests.
+        //
+        for (Index = 0; Index < PacketArrayCount; Index++)
+        {
+            pMpRfd = PacketArray[Index];
+            pMpRfd->DirectRequest = NULL;
+
+            InsertTailList(&FdoData->DirectRfdList, &pMpRfd->List);
+            FdoData->nIdleDirectRfd++;
+        }
+    }
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ, "<--- NICHandleDirectRecvInterrupt\n");
+}
+
+VOID
+NICEvtDirectReadCancel(
+    IN WDFREQUEST       Request
+    )
+/*++
+Routine Description:
+
+    Cancel routine for read requests posted to the receive unit.
+
+Arguments:
+
+    Request - Handle to a framework request object.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PFDO_DATA   fdoData;
+    PMP_RFD     pMpRfd;
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ,
+                "--> NICEvtDirectReadCancel Request %p\n", Request);
+
+    fdoData = FdoGetData(WdfIoQueueGetDevice(WdfRequestGetIoQueue(Request)));
+
+    WdfSpinLockAcquire(fdoData->RcvLock);
+
+    pMpRfd = NICFindDirectRfd(fdoData, Request);
+    if (pMpRfd)
+    {
+        NICDetachDirectRfd(fdoData, pMpRfd);
+    }
+
+    WdfSpinLockRelease(fdoData->RcvLock);
+
+    WdfRequestCompleteWithInformation(Request, STATUS_CANCELLED, 0);
+}
+
+VOID
+PciDrvEvtIoStopRead(
+    IN WDFQUEUE         Queue,
+    IN WDFREQUEST       Request,
+    IN ULONG            ActionFlags
+    )
+/*++
+Routine Description:
+
+    Called for each posted read request when the device is leaving D0 or
+    being removed. Take the buffer back from the hardware and requeue the
+    request so that it is posted again once we are back in D0.
+
+Arguments:
+
+    Queue - Handle to the framework queue object that is associated
+            with the I/O request.
+    Request - Handle to a framework request object.
+    ActionFlags - WDF_REQUEST_STOP_ACTION_FLAGS
+
+Return Value:
+
+    None
+
+--*/
+{
+    PFDO_DATA   fdoData;
+    PMP_RFD     pMpRfd;
+    BOOLEAN     bOwned = FALSE;
+
+    fdoData = FdoGetData(WdfIoQueueGetDevice(Queue));
+
+    WdfSpinLockAcquire(fdoData->RcvLock);
+
+    pMpRfd = NICFindDirectRfd(fdoData, Request);
+
+    //
+    // If the request is being canceled leave it to the cancel routine.
+    //
+    if (pMpRfd && WdfRequestUnmarkCancelable(Request) != STATUS_CANCELLED)
+    {
+        NICDetachDirectRfd(fdoData, pMpRfd);
+        bOwned = TRUE;
+    }
+
+    WdfSpinLockRelease(fdoData->RcvLock);
+
+    if (bOwned)
+    {
+        if (ActionFlags & WdfRequestStopActionSuspend)
+        {
+            WdfRequestStopAcknowledge(Request, TRUE);
+        }
+        else
+        {
+            WdfRequestCompleteWithInformation(Request, STATUS_CANCELLED, 0);
+        }
+    }
+}
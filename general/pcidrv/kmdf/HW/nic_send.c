@@ -127,6 +127,19 @@ Return Value:
     hDevice = WdfIoQueueGetDevice(Queue);
     FdoData = FdoGetData(hDevice);
 
+    //
+    // Everything built until we flush below, including whatever other
+    // writes are submitted meanwhile, goes to the CU with one resume.
+    //
+    WdfSpinLockAcquire(FdoData->SendLock);
+    FdoData->SendBatchOwners++;
+    WdfSpinLockRelease(FdoData->SendLock);
+
+    //
+    // Writes that were queued waiting for TCBs go first.
+    //
+    NICCheckForQueuedSends(FdoData);
+
     status = WdfRequestRetrieveInputWdmMdl(Request, &mdl);
     if (!NT_SUCCESS(status))
     {
@@ -143,6 +156,11 @@ Return Value:
         }
     }
 
+    WdfSpinLockAcquire(FdoData->SendLock);
+    FdoData->SendBatchOwners--;
+    NICFlushSends(FdoData);
+    WdfSpinLockRelease(FdoData->SendLock);
+
     TraceEvents(TRACE_LEVEL_VERBOSE, DBG_WRITE,
                 "<-- PciDrvEvtIoWrite %X\n", status);
 
@@ -301,6 +319,15 @@ Return Value:
             WdfRequestCompleteWithInformation(request, STATUS_UNSUCCESSFUL, 0);
             return FALSE;
         }
+
+        //
+        // Nobody is going to flush the batch after us if the framework
+        // called us back later, outside of PciDrvEvtIoWrite.
+        //
+        if (fdoData->SendBatchOwners == 0)
+        {
+            NICFlushSends(fdoData);
+        }
     }
 
 
@@ -425,15 +452,74 @@ Return Value:
     pHwTcb->TxCbCount = 0;
     pHwTcb->TxCbThreshold = (UCHAR) FdoData->AiThreshold;
 
+    //
+    // Add this TCB to the batch that has not been given to the CU yet.
+    // The CU stops at the suspend bit of the last TCB it was given, so
+    // the TCBs behind it can be chained without racing the hardware.
+    //
+    if (FdoData->SendBatchHead == NULL)
+    {
+        FdoData->SendBatchHead = pMpTcb;
+    }
+    else
+    {
+        pMpTcb->PrevHwTcb->TxCbHeader.CbCommand &= ~CB_S_BIT;
+    }
+
+    FdoData->SendPackets++;
+
+    status = STATUS_SUCCESS;
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_WRITE, "<-- NICSendPacket\n");
+
+    return status;
+}
+
+_Requires_lock_held_(FdoData->SendLock)
+NTSTATUS
+NICFlushSends(
+    IN  PFDO_DATA  FdoData
+    )
+/*++
+Routine Description:
+
+    Hand the batch of TCBs built by NICSendPacket to the NIC with a single
+    CU start or resume command.
+
+    Assumption: This function is called with the Send SPINLOCK held.
+
+Arguments:
+
+    FdoData     Pointer to our FdoData
+
+Return Value:
+
+    NTSTATUS code
+
+--*/
+{
+    NTSTATUS    status;
+    PMP_TCB     pMpTcb = FdoData->SendBatchHead;
+
+    if (pMpTcb == NULL)
+    {
+        return STATUS_SUCCESS;
+    }
+
+    FdoData->SendBatchHead = NULL;
 
     status = NICStartSend(FdoData, pMpTcb);
 
     if(!NT_SUCCESS(status)){
+        //
+        // The TCBs stay on the busy list; the watchdog will find the send
+        // stuck and reset the NIC, which completes them.
+        //
         TraceEvents(TRACE_LEVEL_ERROR, DBG_WRITE,
                    "NICStartSend returned error %x\n", status);
     }
 
-    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_WRITE, "<-- NICSendPacket\n");
+    FdoData->SendDoorbells++;
 
     return status;
 }
@@ -685,9 +771,14 @@ Return Value:
     TraceEvents(TRACE_LEVEL_VERBOSE, DBG_WRITE,
                 "--> NICCheckForQueuedSends\n");
 
+    WdfSpinLockAcquire(FdoData->SendLock);
+    FdoData->SendBatchOwners++;
+    WdfSpinLockRelease(FdoData->SendLock);
+
     //
     // If we queued any transmits because we didn't have any TCBs earlier,
     // dequeue and send those packets now, as long as we have free TCBs.
+    // They all go to the CU together once we are done.
     //
     while (MP_TCB_RESOURCES_AVAIABLE(FdoData))
     {
@@ -715,6 +806,11 @@ Return Value:
         FdoData->nWaitSend--;
     }
 
+    WdfSpinLockAcquire(FdoData->SendLock);
+    FdoData->SendBatchOwners--;
+    NICFlushSends(FdoData);
+    WdfSpinLockRelease(FdoData->SendLock);
+
     TraceEvents(TRACE_LEVEL_VERBOSE, DBG_WRITE,
                 "<-- NICCheckForQueuedSends\n");
 }
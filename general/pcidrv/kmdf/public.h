@@ -41,6 +41,11 @@ DEFINE_GUID (PCIDRV_WMI_STD_DATA_GUID,
 
 // {20E35E40-7179-4f89-A28C-12ED5A3CAAA5}
 
+DEFINE_GUID (PCIDRV_WMI_SEND_STATISTICS_GUID,
+    0x3b5b2e8a, 0x5c1d, 0x4c59, 0x9f, 0x0e, 0x6d, 0x2a, 0x9b, 0xc4, 0x1f, 0x72);
+
+// {3B5B2E8A-5C1D-4c59-9F0E-6D2A9BC41F72}
+
 //
 // GUID definition are required to be outside of header inclusion pragma to avoid
 // error during precompiled headers.
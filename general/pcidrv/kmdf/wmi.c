@@ -35,10 +35,13 @@ EVT_WDF_WMI_INSTANCE_QUERY_INSTANCE EvtWmiDeviceInfoQueryInstance;
 
 EVT_WDF_WMI_INSTANCE_SET_INSTANCE EvtWmiDeviceInfoSetInstance;
 
+EVT_WDF_WMI_INSTANCE_QUERY_INSTANCE EvtWmiSendStatisticsQueryInstance;
+
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE, PciDrvWmiRegistration)
 #pragma alloc_text(PAGE, EvtWmiDeviceInfoQueryInstance)
 #pragma alloc_text(PAGE, EvtWmiDeviceInfoSetInstance)
+#pragma alloc_text(PAGE, EvtWmiSendStatisticsQueryInstance)
 #endif
 
 NTSTATUS
@@ -89,6 +92,23 @@ Routine Description
         return status;
     }
 
+    WDF_WMI_PROVIDER_CONFIG_INIT(&providerConfig, &PCIDRV_WMI_SEND_STATISTICS_GUID);
+    providerConfig.MinInstanceBufferSize = sizeof(PCIDRV_WMI_SEND_STATISTICS);
+
+    WDF_WMI_INSTANCE_CONFIG_INIT_PROVIDER_CONFIG(&instanceConfig, &providerConfig);
+    instanceConfig.Register = TRUE;
+    instanceConfig.EvtWmiInstanceQueryInstance = EvtWmiSendStatisticsQueryInstance;
+
+    status = WdfWmiInstanceCreate(Device,
+                                  &instanceConfig,
+                                  WDF_NO_OBJECT_ATTRIBUTES,
+                                  WDF_NO_HANDLE);
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_PNP,
+                     "WdfWmiInstanceCreate(SendStatistics) failed 0x%x", status);
+        return status;
+    }
+
     return status;
 }
 
@@ -142,3 +162,42 @@ EvtWmiDeviceInfoSetInstance(
     return STATUS_SUCCESS;
 }
 
+NTSTATUS
+EvtWmiSendStatisticsQueryInstance(
+    _In_  WDFWMIINSTANCE WmiInstance,
+    _In_  ULONG OutBufferSize,
+    _Out_writes_bytes_to_(OutBufferSize, *BufferUsed) PVOID OutBuffer,
+    _Out_ PULONG BufferUsed
+    )
+{
+    PFDO_DATA fdoData;
+    PPCIDRV_WMI_SEND_STATISTICS sendStatistics;
+
+    PAGED_CODE();
+
+    fdoData = FdoGetData(WdfWmiInstanceGetDevice(WmiInstance));
+
+    *BufferUsed = sizeof(PCIDRV_WMI_SEND_STATISTICS);
+
+    if (OutBufferSize < sizeof(PCIDRV_WMI_SEND_STATISTICS)) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    sendStatistics = (PPCIDRV_WMI_SEND_STATISTICS)OutBuffer;
+    RtlZeroMemory(sendStatistics, OutBufferSize);
+
+    WdfSpinLockAcquire(fdoData->SendLock);
+
+    sendStatistics->SendPackets = fdoData->SendPackets;
+    sendStatistics->SendDoorbells = fdoData->SendDoorbells;
+
+    WdfSpinLockRelease(fdoData->SendLock);
+
+    if (sendStatistics->SendPackets) {
+        sendStatistics->DoorbellsPerKilopacket =
+            (UINT32)((sendStatistics->SendDoorbells * 1000) / sendStatistics->SendPackets);
+    }
+
+    return STATUS_SUCCESS;
+}
+
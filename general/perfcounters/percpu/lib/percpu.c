@@ -0,0 +1,396 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    percpu.c
+
+Abstract:
+
+    This module implements the per-processor counter library: creation of
+    counter sets and instances, and the PCW callback that sums the
+    per-processor counters when the counter set is queried.
+
+Environment:
+
+    Kernel mode only.
+
+--*/
+
+
+#include <wdm.h>
+#include <ntstrsafe.h>
+#include "percpu.h"
+
+typedef struct _PCPU_COUNTER_SET {
+
+    ULONG CounterCount;
+    ULONG PoolTag;
+
+    //
+    // Number of per-processor copies in each instance, and the distance
+    // between them.
+    //
+    ULONG ProcessorCount;
+    ULONG Stride;
+
+    //
+    // Protects InstanceList. Queries take it shared, so several consumers
+    // can collect data at once; it stays at PASSIVE_LEVEL because
+    // PcwAddInstance must not be called at raised IRQL.
+    //
+    ERESOURCE Lock;
+    LIST_ENTRY InstanceList;
+
+} PCPU_COUNTER_SET;
+
+#pragma code_seg("PAGE")
+
+NTSTATUS
+PcpuCounterSetCreate (
+    _In_ ULONG CounterCount,
+    _In_ ULONG PoolTag,
+    _Out_ PPCPU_COUNTER_SET *CounterSet
+    )
+
+/*++
+
+Routine Description:
+
+    This function creates an empty counter set.
+
+Arguments:
+
+    CounterCount - Number of ULONG64 counters in each instance.
+
+    PoolTag - Tag used for all the allocations of the counter set.
+
+    CounterSet - Receives the new counter set.
+
+Return Value:
+
+    NTSTATUS indicating if the function succeeded.
+
+--*/
+
+{
+    NTSTATUS Status;
+    PPCPU_COUNTER_SET Set;
+
+    PAGED_CODE();
+
+    *CounterSet = NULL;
+
+    if (CounterCount == 0 || CounterCount > PCPU_MAX_COUNTERS) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    Set = ExAllocatePoolWithTag(NonPagedPoolNx, sizeof(*Set), PoolTag);
+    if (Set == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(Set, sizeof(*Set));
+
+    Status = ExInitializeResourceLite(&Set->Lock);
+    if (!NT_SUCCESS(Status)) {
+        ExFreePoolWithTag(Set, PoolTag);
+        return Status;
+    }
+
+    Set->CounterCount = CounterCount;
+    Set->PoolTag = PoolTag;
+    Set->ProcessorCount = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    Set->Stride = (ULONG)((CounterCount * sizeof(ULONG64) +
+                           SYSTEM_CACHE_ALIGNMENT_SIZE - 1) &
+                          ~((ULONG_PTR)SYSTEM_CACHE_ALIGNMENT_SIZE - 1));
+    InitializeListHead(&Set->InstanceList);
+
+    *CounterSet = Set;
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+PcpuCounterSetDelete (
+    _In_ PPCPU_COUNTER_SET CounterSet
+    )
+
+/*++
+
+Routine Description:
+
+    This function deletes a counter set. The counter set must already be
+    unregistered from PCW and all its instances deleted.
+
+Arguments:
+
+    CounterSet - Counter set to delete.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PAGED_CODE();
+
+    NT_ASSERT(IsListEmpty(&CounterSet->InstanceList));
+
+    ExDeleteResourceLite(&CounterSet->Lock);
+    ExFreePoolWithTag(CounterSet, CounterSet->PoolTag);
+}
+
+NTSTATUS
+PcpuInstanceCreate (
+    _In_ PPCPU_COUNTER_SET CounterSet,
+    _In_ PCWSTR Name,
+    _In_ ULONG Id,
+    _Out_ PPCPU_INSTANCE *Instance
+    )
+
+/*++
+
+Routine Description:
+
+    This function creates an instance with all its counters at zero and
+    adds it to the counter set, so the next query reports it.
+
+Arguments:
+
+    CounterSet - Counter set the instance belongs to.
+
+    Name - Name of the instance, copied into the instance.
+
+    Id - Instance identifier reported to PCW.
+
+    Instance - Receives the new instance.
+
+Return Value:
+
+    NTSTATUS indicating if the function succeeded.
+
+--*/
+
+{
+    NTSTATUS Status;
+    PPCPU_INSTANCE NewInstance;
+    SIZE_T Size;
+
+    PAGED_CODE();
+
+    *Instance = NULL;
+
+    NewInstance = ExAllocatePoolWithTag(NonPagedPoolNx,
+                                        sizeof(*NewInstance),
+                                        CounterSet->PoolTag);
+    if (NewInstance == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(NewInstance, sizeof(*NewInstance));
+
+    Status = RtlStringCbCopyW(NewInstance->NameBuffer,
+                              sizeof(NewInstance->NameBuffer),
+                              Name);
+    if (!NT_SUCCESS(Status)) {
+        ExFreePoolWithTag(NewInstance, CounterSet->PoolTag);
+        return Status;
+    }
+
+    RtlInitUnicodeString(&NewInstance->Name, NewInstance->NameBuffer);
+
+    //
+    // Cache aligned pool starts the block on a cache line, and the stride
+    // keeps every processor's copy on lines of its own.
+    //
+    Size = (SIZE_T)CounterSet->Stride * CounterSet->ProcessorCount;
+
+    NewInstance->Counters = ExAllocatePoolWithTag(NonPagedPoolNxCacheAligned,
+                                                  Size,
+                                                  CounterSet->PoolTag);
+    if (NewInstance->Counters == NULL) {
+        ExFreePoolWithTag(NewInstance, CounterSet->PoolTag);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(NewInstance->Counters, Size);
+
+    NewInstance->Stride = CounterSet->Stride;
+    NewInstance->CounterSet = CounterSet;
+    NewInstance->Id = Id;
+
+    KeEnterCriticalRegion();
+    ExAcquireResourceExclusiveLite(&CounterSet->Lock, TRUE);
+    InsertTailList(&CounterSet->InstanceList, &NewInstance->ListEntry);
+    ExReleaseResourceLite(&CounterSet->Lock);
+    KeLeaveCriticalRegion();
+
+    *Instance = NewInstance;
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+PcpuInstanceDelete (
+    _In_ PPCPU_INSTANCE Instance
+    )
+
+/*++
+
+Routine Description:
+
+    This function removes an instance from its counter set and frees it.
+    The caller must make sure nothing updates the instance any more.
+
+Arguments:
+
+    Instance - Instance to delete.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PPCPU_COUNTER_SET CounterSet = Instance->CounterSet;
+
+    PAGED_CODE();
+
+    //
+    // Once the exclusive lock is held no query is still reading the
+    // instance.
+    //
+
+    KeEnterCriticalRegion();
+    ExAcquireResourceExclusiveLite(&CounterSet->Lock, TRUE);
+    RemoveEntryList(&Instance->ListEntry);
+    ExReleaseResourceLite(&CounterSet->Lock);
+    KeLeaveCriticalRegion();
+
+    ExFreePoolWithTag(Instance->Counters, CounterSet->PoolTag);
+    ExFreePoolWithTag(Instance, CounterSet->PoolTag);
+}
+
+NTSTATUS NTAPI
+PcpuCounterSetCallback (
+    _In_ PCW_CALLBACK_TYPE Type,
+    _In_ PPCW_CALLBACK_INFORMATION Info,
+    _In_opt_ PVOID Context
+    )
+
+/*++
+
+Routine Description:
+
+    This function returns the list of counter instances and counter data.
+    For a data collection, the copies of each counter on every processor
+    are summed here, so the cost of aggregation is paid per query rather
+    than per update.
+
+    The copies are read while other processors may update them, so a sum
+    is a snapshot rather than an exact value at one instant. On 32-bit
+    systems a read can also see a half-updated copy when its low part
+    carries into its high part.
+
+Arguments:
+
+    Type - Request type.
+
+    Info - Buffer for returned data.
+
+    Context - Counter set being queried.
+
+Return Value:
+
+    NTSTATUS indicating if the function succeeded.
+
+--*/
+
+{
+    PPCW_BUFFER Buffer;
+    PPCPU_COUNTER_SET CounterSet = Context;
+    ULONG Counter;
+    volatile ULONG64 *Counters;
+    PCW_DATA Data;
+    PLIST_ENTRY Entry;
+    PPCPU_INSTANCE Instance;
+    ULONG Processor;
+    NTSTATUS Status;
+    ULONG64 Values[PCPU_MAX_COUNTERS];
+
+    PAGED_CODE();
+
+    switch (Type) {
+    case PcwCallbackEnumerateInstances:
+        Buffer = Info->EnumerateInstances.Buffer;
+        break;
+
+    case PcwCallbackCollectData:
+        Buffer = Info->CollectData.Buffer;
+        break;
+
+    default:
+        return STATUS_SUCCESS;
+    }
+
+    if (CounterSet == NULL) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    Data.Data = Values;
+    Data.Size = CounterSet->CounterCount * sizeof(ULONG64);
+
+    Status = STATUS_SUCCESS;
+
+    KeEnterCriticalRegion();
+    ExAcquireResourceSharedLite(&CounterSet->Lock, TRUE);
+
+    for (Entry = CounterSet->InstanceList.Flink;
+         Entry != &CounterSet->InstanceList;
+         Entry = Entry->Flink) {
+
+        Instance = CONTAINING_RECORD(Entry, PCPU_INSTANCE, ListEntry);
+
+        RtlZeroMemory(Values, sizeof(Values));
+
+        //
+        // Instances are being enumerated, so we add them without values.
+        //
+
+        if (Type == PcwCallbackCollectData) {
+            for (Processor = 0;
+                 Processor < CounterSet->ProcessorCount;
+                 Processor += 1) {
+
+                Counters = (volatile ULONG64 *)(Instance->Counters +
+                                                Instance->Stride * Processor);
+
+                for (Counter = 0;
+                     Counter < CounterSet->CounterCount;
+                     Counter += 1) {
+
+                    Values[Counter] += Counters[Counter];
+                }
+            }
+        }
+
+        Status = PcwAddInstance(Buffer, &Instance->Name, Instance->Id, 1, &Data);
+        if (!NT_SUCCESS(Status)) {
+            break;
+        }
+    }
+
+    ExReleaseResourceLite(&CounterSet->Lock);
+    KeLeaveCriticalRegion();
+
+    return Status;
+}
@@ -0,0 +1,188 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    percpu.h
+
+Abstract:
+
+    Interface of the per-processor counter library.
+
+    A counter set describes a group of 64-bit counters that are published
+    through one kernel-mode PCW counter set. Each instance of the set (for
+    example one per I/O queue) keeps a private copy of its counters for
+    every processor, padded to a cache line, so the hot path updates them
+    with plain additions and processors never share a line. The values are
+    summed across processors only when a consumer queries the counter set,
+    from PcpuCounterSetCallback.
+
+    The counters of a set must be laid out in the manifest as a structure of
+    ULONG64 fields, in counter index order.
+
+Environment:
+
+    Kernel mode only.
+
+--*/
+
+#pragma once
+
+//
+// Largest number of counters in one counter set. The query callback sums
+// an instance into a stack buffer of this size.
+//
+#define PCPU_MAX_COUNTERS       16
+
+typedef struct _PCPU_COUNTER_SET *PPCPU_COUNTER_SET;
+
+typedef struct _PCPU_INSTANCE {
+
+    //
+    // Bytes between the counters of consecutive processors, a multiple of
+    // the cache line size.
+    //
+    ULONG Stride;
+
+    //
+    // Counters of processor 0. Those of processor N start Stride * N bytes
+    // further on.
+    //
+    PUCHAR Counters;
+
+    //
+    // The fields below are private to the library.
+    //
+    LIST_ENTRY ListEntry;
+    PPCPU_COUNTER_SET CounterSet;
+    ULONG Id;
+    UNICODE_STRING Name;
+    WCHAR NameBuffer[32];
+
+} PCPU_INSTANCE, *PPCPU_INSTANCE;
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+PcpuCounterSetCreate (
+    _In_ ULONG CounterCount,
+    _In_ ULONG PoolTag,
+    _Out_ PPCPU_COUNTER_SET *CounterSet
+    );
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+PcpuCounterSetDelete (
+    _In_ PPCPU_COUNTER_SET CounterSet
+    );
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+PcpuInstanceCreate (
+    _In_ PPCPU_COUNTER_SET CounterSet,
+    _In_ PCWSTR Name,
+    _In_ ULONG Id,
+    _Out_ PPCPU_INSTANCE *Instance
+    );
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+PcpuInstanceDelete (
+    _In_ PPCPU_INSTANCE Instance
+    );
+
+//
+// Pass this routine, with the counter set as its context, to the
+// registration routine that ctrpp generates for the counter set.
+//
+PCW_CALLBACK PcpuCounterSetCallback;
+
+_IRQL_requires_min_(DISPATCH_LEVEL)
+FORCEINLINE
+VOID
+PcpuCounterAddAtDpcLevel (
+    _In_ PPCPU_INSTANCE Instance,
+    _In_ ULONG Counter,
+    _In_ ULONG64 Value
+    )
+
+/*++
+
+Routine Description:
+
+    This function adds to a counter of the current processor. The caller
+    cannot be preempted at DISPATCH_LEVEL, so no other code updates this
+    copy of the counter concurrently and a plain addition is enough.
+
+Arguments:
+
+    Instance - Instance whose counter is updated.
+
+    Counter - Index of the counter.
+
+    Value - Amount to add.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PULONG64 Counters;
+
+    Counters = (PULONG64)(Instance->Counters +
+                          Instance->Stride * KeGetCurrentProcessorIndex());
+
+    Counters[Counter] += Value;
+}
+
+_IRQL_requires_max_(HIGH_LEVEL)
+FORCEINLINE
+VOID
+PcpuCounterAdd (
+    _In_ PPCPU_INSTANCE Instance,
+    _In_ ULONG Counter,
+    _In_ ULONG64 Value
+    )
+
+/*++
+
+Routine Description:
+
+    This function adds to a counter of the current processor from any IRQL.
+    Below DISPATCH_LEVEL the IRQL is raised around the addition so the
+    thread cannot move to another processor between finding its copy of the
+    counter and updating it.
+
+Arguments:
+
+    Instance - Instance whose counter is updated.
+
+    Counter - Index of the counter.
+
+    Value - Amount to add.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    KIRQL OldIrql;
+
+    if (KeGetCurrentIrql() >= DISPATCH_LEVEL) {
+        PcpuCounterAddAtDpcLevel(Instance, Counter, Value);
+
+    } else {
+        KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+        PcpuCounterAddAtDpcLevel(Instance, Counter, Value);
+        KeLowerIrql(OldIrql);
+    }
+}
@@ -0,0 +1,318 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    percpusamp.c
+
+Abstract:
+
+    This module contains sample code to demonstrate how to provide
+    high-frequency counter data from a kernel driver.
+
+    The driver simulates several I/O queues. Each queue is one instance of
+    the QueueCounters counter set, and its DPC updates the counters with the
+    per-processor counter library for every simulated request. The queues'
+    DPCs are spread across the processors, so the per-processor copies of
+    the counters are really in use. Nothing is summed until a consumer
+    queries the counter set.
+
+Environment:
+
+    Kernel mode only.
+
+--*/
+
+
+#include <wdm.h>
+#include <ntstrsafe.h>
+#include "percpu.h"
+#include "percpusamp.h"
+#include "PcsCounters.h"
+
+DRIVER_INITIALIZE DriverEntry;
+DRIVER_UNLOAD PcsUnload;
+KDEFERRED_ROUTINE PcsQueueDpc;
+
+PPCPU_COUNTER_SET PcsCounterSet;
+PCS_QUEUE PcsQueues[PCS_QUEUE_COUNT];
+BOOLEAN PcsRegistered;
+BOOLEAN PcsTimersStarted;
+
+VOID
+PcsQueueDpc (
+    _In_ PKDPC Dpc,
+    _In_opt_ PVOID DeferredContext,
+    _In_opt_ PVOID SystemArgument1,
+    _In_opt_ PVOID SystemArgument2
+    )
+
+/*++
+
+Routine Description:
+
+    This function simulates a burst of requests on one queue. It stands in
+    for the hot path of a real driver: each request costs a few plain
+    additions to counters that no other processor writes.
+
+Arguments:
+
+    Dpc - Not used.
+
+    DeferredContext - The simulated queue.
+
+    SystemArgument1 - Not used.
+
+    SystemArgument2 - Not used.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    ULONG Length;
+    PPCS_QUEUE Queue = DeferredContext;
+    ULONG Request;
+
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    if (Queue == NULL) {
+        return;
+    }
+
+    for (Request = 0; Request < PCS_REQUESTS_PER_BURST; Request += 1) {
+
+        //
+        // A linear congruential step gives each request a pseudo-random
+        // length of up to 64 KB and fails about one request in 256.
+        //
+
+        Queue->Seed = Queue->Seed * 1664525 + 1013904223;
+        Length = (Queue->Seed >> 8) & 0xFFFF;
+
+        PcpuCounterAddAtDpcLevel(Queue->Counters, QueueCounterRequests, 1);
+        PcpuCounterAddAtDpcLevel(Queue->Counters, QueueCounterBytes, Length);
+
+        if ((Queue->Seed >> 24) == 0) {
+            PcpuCounterAddAtDpcLevel(Queue->Counters, QueueCounterErrors, 1);
+        }
+    }
+}
+
+#pragma code_seg("PAGE")
+
+VOID
+PcsCleanup (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This function stops the simulated queues, unregisters the counter set
+    and frees the counters.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    ULONG Index;
+
+    PAGED_CODE();
+
+    if (PcsTimersStarted) {
+        for (Index = 0; Index < PCS_QUEUE_COUNT; Index += 1) {
+            KeCancelTimer(&PcsQueues[Index].Timer);
+        }
+
+        //
+        // Wait for DPCs that were already queued before freeing the
+        // counters they update.
+        //
+
+        KeFlushQueuedDpcs();
+        PcsTimersStarted = FALSE;
+    }
+
+    //
+    // Unregister the counter set so no new query starts, then delete the
+    // instances.
+    //
+
+    if (PcsRegistered) {
+        PcsUnregisterQueueCounters();
+        PcsRegistered = FALSE;
+    }
+
+    for (Index = 0; Index < PCS_QUEUE_COUNT; Index += 1) {
+        if (PcsQueues[Index].Counters != NULL) {
+            PcpuInstanceDelete(PcsQueues[Index].Counters);
+            PcsQueues[Index].Counters = NULL;
+        }
+    }
+
+    if (PcsCounterSet != NULL) {
+        PcpuCounterSetDelete(PcsCounterSet);
+        PcsCounterSet = NULL;
+    }
+}
+
+VOID
+PcsUnload (
+    _In_ PDRIVER_OBJECT DriverObject
+    )
+
+/*++
+
+Routine Description:
+
+    This function unregisters the counter set and stops the simulation.
+
+Arguments:
+
+    DriverObject - Not used.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    UNREFERENCED_PARAMETER(DriverObject);
+
+    PAGED_CODE();
+
+    PcsCleanup();
+}
+
+NTSTATUS
+DriverEntry (
+    _In_ PDRIVER_OBJECT DriverObject,
+    _In_ PUNICODE_STRING RegistryPath
+    )
+
+/*++
+
+Routine Description:
+
+    This function creates one counter set instance per simulated queue,
+    registers the counter set and starts the queues' timers.
+
+Arguments:
+
+    DriverObject - Supplies the driver object of the driver being loaded.
+
+    RegistryPath - Not used.
+
+Return Value:
+
+    NTSTATUS indicating if driver was properly loaded.
+
+--*/
+
+{
+    ULONG ActiveProcessors;
+    LARGE_INTEGER DueTime;
+    ULONG Index;
+    WCHAR Name[16];
+    PROCESSOR_NUMBER ProcessorNumber;
+    NTSTATUS Status;
+
+    UNREFERENCED_PARAMETER(RegistryPath);
+
+    PAGED_CODE();
+
+    Status = PcpuCounterSetCreate(QueueCounterCount,
+                                  PCS_POOL_TAG,
+                                  &PcsCounterSet);
+    if (!NT_SUCCESS(Status)) {
+        return Status;
+    }
+
+    for (Index = 0; Index < PCS_QUEUE_COUNT; Index += 1) {
+        Status = RtlStringCbPrintfW(Name, sizeof(Name), L"Queue %u", Index);
+        if (!NT_SUCCESS(Status)) {
+            goto Exit;
+        }
+
+        Status = PcpuInstanceCreate(PcsCounterSet,
+                                    Name,
+                                    Index,
+                                    &PcsQueues[Index].Counters);
+        if (!NT_SUCCESS(Status)) {
+            goto Exit;
+        }
+    }
+
+    //
+    // Register the counter set with the library's callback, which sums the
+    // per-processor counters of every instance when the set is queried.
+    //
+
+    Status = PcsRegisterQueueCounters(PcpuCounterSetCallback, PcsCounterSet);
+    if (!NT_SUCCESS(Status)) {
+        goto Exit;
+    }
+
+    PcsRegistered = TRUE;
+
+    //
+    // Run each queue's DPC on a different processor.
+    //
+
+    ActiveProcessors = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    DueTime.QuadPart = -10000LL * PCS_TIMER_PERIOD_MS;
+
+    for (Index = 0; Index < PCS_QUEUE_COUNT; Index += 1) {
+        PcsQueues[Index].Seed = Index + 1;
+
+        KeInitializeTimer(&PcsQueues[Index].Timer);
+        KeInitializeDpc(&PcsQueues[Index].Dpc,
+                        PcsQueueDpc,
+                        &PcsQueues[Index]);
+
+        if (NT_SUCCESS(KeGetProcessorNumberFromIndex(Index % ActiveProcessors,
+                                                     &ProcessorNumber))) {
+            KeSetTargetProcessorDpcEx(&PcsQueues[Index].Dpc, &ProcessorNumber);
+        }
+
+        KeSetTimerEx(&PcsQueues[Index].Timer,
+                     DueTime,
+                     PCS_TIMER_PERIOD_MS,
+                     &PcsQueues[Index].Dpc);
+    }
+
+    PcsTimersStarted = TRUE;
+
+    //
+    // Success path - set up unload routine and return success.
+    //
+
+    DriverObject->DriverUnload = PcsUnload;
+
+Exit:
+    if (!NT_SUCCESS(Status)) {
+        PcsCleanup();
+    }
+
+    return Status;
+}
@@ -0,0 +1,61 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    percpusamp.h
+
+Abstract:
+
+    This module contains sample code to demonstrate how to provide
+    high-frequency counter data from a kernel driver with the per-processor
+    counter library.
+
+Environment:
+
+    Kernel mode only.
+
+--*/
+
+//
+// Counters of one simulated queue, in the order of the QueueCounters
+// counter set in percpusamp.man. The library treats the structure as an
+// array of ULONG64 indexed by QUEUE_COUNTER.
+//
+
+typedef struct _QUEUE_COUNTER_VALUES {
+    ULONG64 Requests;
+    ULONG64 Bytes;
+    ULONG64 Errors;
+} QUEUE_COUNTER_VALUES, *PQUEUE_COUNTER_VALUES;
+
+typedef enum _QUEUE_COUNTER {
+    QueueCounterRequests = 0,
+    QueueCounterBytes,
+    QueueCounterErrors,
+    QueueCounterCount
+} QUEUE_COUNTER;
+
+C_ASSERT(sizeof(QUEUE_COUNTER_VALUES) == QueueCounterCount * sizeof(ULONG64));
+
+#define PCS_POOL_TAG            'sCcP'
+#define PCS_QUEUE_COUNT         4
+
+//
+// Each queue's timer fires every 10 ms and simulates a burst of requests.
+//
+#define PCS_TIMER_PERIOD_MS     10
+#define PCS_REQUESTS_PER_BURST  256
+
+typedef struct _PCS_QUEUE {
+    PPCPU_INSTANCE Counters;
+    KTIMER Timer;
+    KDPC Dpc;
+    ULONG Seed;
+} PCS_QUEUE, *PPCS_QUEUE;
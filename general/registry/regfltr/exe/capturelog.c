@@ -0,0 +1,404 @@
+/*++
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    CaptureLog.c
+
+Abstract:
+
+    A sample that shows how to drain a capture log mapped from the driver
+
+Environment:
+
+    User mode only
+
+--*/
+
+#include "regctrl.h"
+
+
+//
+// Number of set value and query value pairs done while draining the log,
+// and how many pairs are done between two drains. A drain interval must
+// produce fewer records than the ring holds or operations are dropped.
+//
+
+#define CAPTURE_LOG_SAMPLE_OPERATIONS       100000
+#define CAPTURE_LOG_SAMPLE_DRAIN_INTERVAL   1024
+
+C_ASSERT(2 * CAPTURE_LOG_SAMPLE_DRAIN_INTERVAL < CAPTURE_LOG_RECORD_COUNT);
+
+//
+// Number of set value operations done without draining, to show what
+// happens when the consumer falls behind.
+//
+
+#define CAPTURE_LOG_SAMPLE_BURST            (2 * CAPTURE_LOG_RECORD_COUNT)
+
+
+typedef struct _CAPTURE_LOG_VIEW {
+
+    PCAPTURE_LOG_HEADER Header;
+    PCAPTURE_LOG_RECORD Records;
+    PUCHAR Arena;
+
+    //
+    // Records drained per operation, and set value records whose name or
+    // data didn't match what the sample set.
+    //
+    ULONG64 Operations[MAX_CAPTURE_LOG_OPERATIONS];
+    ULONG64 Mismatched;
+
+} CAPTURE_LOG_VIEW, *PCAPTURE_LOG_VIEW;
+
+
+ULONG
+DrainCaptureLog(
+    _Inout_ PCAPTURE_LOG_VIEW View
+    )
+/*++
+
+Routine Description:
+
+    Reads all the records the driver has published since the last drain
+    and then gives their ring slots and arena bytes back to the driver.
+
+Arguments:
+
+    View - The mapped capture log.
+
+Return Value:
+
+    Number of records drained.
+
+--*/
+{
+    PCAPTURE_LOG_HEADER Header = View->Header;
+    PCAPTURE_LOG_RECORD Record;
+    PUCHAR Name;
+    ULONG64 Position;
+    ULONG64 ArenaTail;
+    ULONG Drained = 0;
+
+    Position = (ULONG64) Header->RecordTail;
+    ArenaTail = (ULONG64) Header->ArenaTail;
+
+    for (;;) {
+
+        Record = &View->Records[Position & (Header->RecordCount - 1)];
+
+        //
+        // Stop at the first record that is not published yet. Records
+        // after it may be complete already; they are read in the next
+        // drain, in order.
+        //
+
+        if ((ULONG) ReadAcquire((volatile LONG *) &Record->Sequence) != (ULONG) (Position + 1)) {
+            break;
+        }
+
+        if (Record->Operation < MAX_CAPTURE_LOG_OPERATIONS) {
+            View->Operations[Record->Operation] += 1;
+        }
+
+        if (Record->Operation == CAPTURE_LOG_OPERATION_SET_VALUE) {
+
+            Name = View->Arena + (Record->ArenaPosition & (Header->ArenaSize - 1));
+
+            if ((Record->NameLength != sizeof(VALUE_NAME) - sizeof(WCHAR)) ||
+                (memcmp(Name, VALUE_NAME, Record->NameLength) != 0) ||
+                (Record->Type != REG_DWORD) ||
+                (Record->DataLength != sizeof(DWORD))) {
+                View->Mismatched += 1;
+            }
+        }
+
+        ArenaTail = Record->ArenaPosition + Record->NameLength + Record->DataLength;
+        Position += 1;
+        Drained += 1;
+    }
+
+    //
+    // Give the space back. The arena tail doesn't need to be exact; the
+    // driver only uses it to tell whether a reservation fits.
+    //
+
+    if (Drained != 0) {
+        InterlockedExchange64(&Header->ArenaTail, (LONG64) ArenaTail);
+        InterlockedExchange64(&Header->RecordTail, (LONG64) Position);
+    }
+
+    return Drained;
+}
+
+
+VOID
+CaptureLogSample(
+    )
+/*++
+
+Routine Description:
+
+    This sample shows how to log a large number of registry operations
+    without an allocation or an IOCTL per operation.
+
+    The callback appends a record for each operation to a capture log. The
+    sample maps the log into its address space, does many set value and
+    query value operations and drains the log every
+    CAPTURE_LOG_SAMPLE_DRAIN_INTERVAL operations. Every set value operation
+    should be found in the log and nothing should be dropped.
+
+    It then does a burst of set value operations larger than the ring
+    without draining. The driver is expected to drop the operations it has
+    no room for rather than overwrite records that were not read.
+
+    See ..\sys\CaptureLog.c for the callback routine used in this sample.
+
+Return Value:
+
+    None
+
+--*/
+{
+    LONG Res;
+    HRESULT hr;
+    DWORD ValueData = 0;
+    DWORD QueryData;
+    DWORD QueryDataSize;
+    BOOL Result;
+    BOOL Success = FALSE;
+    DWORD BytesReturned;
+    ULONG Operation;
+    ULONG64 Drained = 0;
+    ULONG64 SetValueRecords;
+    LONG64 Dropped;
+    LARGE_INTEGER Start;
+    LARGE_INTEGER End;
+    LARGE_INTEGER Frequency;
+    double Seconds;
+    CAPTURE_LOG_VIEW View = {0};
+    REGISTER_CALLBACK_INPUT RegisterCallbackInput = {0};
+    REGISTER_CALLBACK_OUTPUT RegisterCallbackOutput = {0};
+    UNREGISTER_CALLBACK_INPUT UnRegisterCallbackInput = {0};
+    MAP_CAPTURE_LOG_INPUT MapCaptureLogInput = {0};
+    MAP_CAPTURE_LOG_OUTPUT MapCaptureLogOutput = {0};
+
+
+    InfoPrint("");
+    InfoPrint("=== Capture Log Sample ====");
+
+    //
+    // Register callback
+    //
+
+    RtlZeroMemory(RegisterCallbackInput.Altitude,
+                  MAX_ALTITUDE_BUFFER_LENGTH * sizeof(WCHAR));
+
+    hr = StringCbPrintf(RegisterCallbackInput.Altitude,
+                          MAX_ALTITUDE_BUFFER_LENGTH * sizeof(WCHAR),
+                          CALLBACK_ALTITUDE);
+
+    if (!SUCCEEDED(hr)) {
+        ErrorPrint("Copying altitude string failed. Error %d", hr);
+        goto Exit;
+    }
+
+    RegisterCallbackInput.CallbackMode = CALLBACK_MODE_CAPTURE_LOG;
+
+    Result = DeviceIoControl(g_Driver,
+                             IOCTL_REGISTER_CALLBACK,
+                             &RegisterCallbackInput,
+                             sizeof(REGISTER_CALLBACK_INPUT),
+                             &RegisterCallbackOutput,
+                             sizeof(REGISTER_CALLBACK_OUTPUT),
+                             &BytesReturned,
+                             NULL);
+
+    if (Result != TRUE) {
+        ErrorPrint("RegisterCallback failed. Error %d", GetLastError());
+        goto Exit;
+    }
+
+    //
+    // Map the capture log
+    //
+
+    MapCaptureLogInput.Cookie = RegisterCallbackOutput.Cookie;
+
+    Result = DeviceIoControl(g_Driver,
+                             IOCTL_MAP_CAPTURE_LOG,
+                             &MapCaptureLogInput,
+                             sizeof(MAP_CAPTURE_LOG_INPUT),
+                             &MapCaptureLogOutput,
+                             sizeof(MAP_CAPTURE_LOG_OUTPUT),
+                             &BytesReturned,
+                             NULL);
+
+    if (Result != TRUE) {
+        ErrorPrint("MapCaptureLog failed. Error %d", GetLastError());
+        goto Unregister;
+    }
+
+    View.Header = (PCAPTURE_LOG_HEADER) (ULONG_PTR) MapCaptureLogOutput.ViewBase;
+    View.Records = (PCAPTURE_LOG_RECORD) ((PUCHAR) View.Header + View.Header->RecordsOffset);
+    View.Arena = (PUCHAR) View.Header + View.Header->ArenaOffset;
+
+    InfoPrint("\tCapture log mapped: %u records, %u bytes of arena.",
+              View.Header->RecordCount,
+              View.Header->ArenaSize);
+
+    Success = TRUE;
+
+    //
+    // Set and query a value many times, draining the log as we go.
+    //
+
+    QueryPerformanceFrequency(&Frequency);
+    QueryPerformanceCounter(&Start);
+
+    for (Operation = 0; Operation < CAPTURE_LOG_SAMPLE_OPERATIONS; Operation++) {
+
+        ValueData = Operation;
+
+        Res = RegSetValueEx(g_RootKey,
+                            VALUE_NAME,
+                            0,
+                            REG_DWORD,
+                            (BYTE *) &ValueData,
+                            sizeof(ValueData));
+
+        if (Res != ERROR_SUCCESS) {
+            ErrorPrint("RegSetValueEx return unexpected status %d", Res);
+            Success = FALSE;
+            break;
+        }
+
+        QueryDataSize = sizeof(QueryData);
+
+        Res = RegQueryValueEx(g_RootKey,
+                              VALUE_NAME,
+                              NULL,
+                              NULL,
+                              (BYTE *) &QueryData,
+                              &QueryDataSize);
+
+        if (Res != ERROR_SUCCESS) {
+            ErrorPrint("RegQueryValueEx return unexpected status %d", Res);
+            Success = FALSE;
+            break;
+        }
+
+        if ((Operation + 1) % CAPTURE_LOG_SAMPLE_DRAIN_INTERVAL == 0) {
+            Drained += DrainCaptureLog(&View);
+        }
+    }
+
+    Drained += DrainCaptureLog(&View);
+
+    QueryPerformanceCounter(&End);
+
+    Seconds = (double) (End.QuadPart - Start.QuadPart) / (double) Frequency.QuadPart;
+
+    InfoPrint("\t%I64u records drained in %.3f seconds, %.0f records per second.",
+              Drained,
+              Seconds,
+              Seconds > 0 ? (double) Drained / Seconds : 0.0);
+
+    SetValueRecords = View.Operations[CAPTURE_LOG_OPERATION_SET_VALUE];
+    Dropped = View.Header->Dropped;
+
+    if (Operation == CAPTURE_LOG_SAMPLE_OPERATIONS &&
+        SetValueRecords != CAPTURE_LOG_SAMPLE_OPERATIONS) {
+        ErrorPrint("Set value records expected %d, instead it was %I64u",
+                   CAPTURE_LOG_SAMPLE_OPERATIONS,
+                   SetValueRecords);
+        Success = FALSE;
+    }
+
+    if (View.Mismatched != 0 || Dropped != 0) {
+        ErrorPrint("%I64u set value records did not match and %I64d operations were dropped",
+                   View.Mismatched,
+                   Dropped);
+        Success = FALSE;
+    }
+
+    //
+    // Now set the value more times than the ring holds without draining.
+    // Every operation is either in the log or counted as dropped.
+    //
+
+    for (Operation = 0; Operation < CAPTURE_LOG_SAMPLE_BURST; Operation++) {
+
+        Res = RegSetValueEx(g_RootKey,
+                            VALUE_NAME,
+                            0,
+                            REG_DWORD,
+                            (BYTE *) &ValueData,
+                            sizeof(ValueData));
+
+        if (Res != ERROR_SUCCESS) {
+            ErrorPrint("RegSetValueEx return unexpected status %d", Res);
+            Success = FALSE;
+            break;
+        }
+    }
+
+    DrainCaptureLog(&View);
+
+    SetValueRecords = View.Operations[CAPTURE_LOG_OPERATION_SET_VALUE] - SetValueRecords;
+    Dropped = View.Header->Dropped - Dropped;
+
+    InfoPrint("\tBurst of %u set value operations: %I64u logged, %I64d dropped.",
+              Operation,
+              SetValueRecords,
+              Dropped);
+
+    if ((Dropped == 0) || (SetValueRecords + Dropped != Operation)) {
+        ErrorPrint("Burst expected to be logged or dropped, %I64u logged and %I64d dropped",
+                   SetValueRecords,
+                   Dropped);
+        Success = FALSE;
+    }
+
+    RegDeleteValue(g_RootKey, VALUE_NAME);
+
+    UnmapViewOfFile(View.Header);
+
+  Unregister:
+
+    //
+    // Unregister the callback
+    //
+
+    UnRegisterCallbackInput.Cookie = RegisterCallbackOutput.Cookie;
+
+    Result = DeviceIoControl(g_Driver,
+                             IOCTL_UNREGISTER_CALLBACK,
+                             &UnRegisterCallbackInput,
+                             sizeof(UNREGISTER_CALLBACK_INPUT),
+                             NULL,
+                             0,
+                             &BytesReturned,
+                             NULL);
+
+    if (Result != TRUE) {
+        ErrorPrint("UnRegisterCallback failed. Error %d", GetLastError());
+        Success = FALSE;
+    }
+
+  Exit:
+
+    if (Success) {
+        InfoPrint("Capture Log Sample succeeded.");
+    } else {
+        ErrorPrint("Capture Log Sample failed.");
+    }
+
+}
+
@@ -48,6 +48,7 @@ Environment:
 #define IOCTL_REGISTER_CALLBACK        CTL_CODE (FILE_DEVICE_UNKNOWN, (0x800 + 1), METHOD_BUFFERED, FILE_SPECIAL_ACCESS)
 #define IOCTL_UNREGISTER_CALLBACK      CTL_CODE (FILE_DEVICE_UNKNOWN, (0x800 + 2), METHOD_BUFFERED, FILE_SPECIAL_ACCESS)
 #define IOCTL_GET_CALLBACK_VERSION     CTL_CODE (FILE_DEVICE_UNKNOWN, (0x800 + 3), METHOD_BUFFERED, FILE_SPECIAL_ACCESS)
+#define IOCTL_MAP_CAPTURE_LOG          CTL_CODE (FILE_DEVICE_UNKNOWN, (0x800 + 4), METHOD_BUFFERED, FILE_SPECIAL_ACCESS)
 
 //
 // Common definitions
@@ -86,6 +87,8 @@ typedef enum _CALLBACK_MODE {
     CALLBACK_MODE_CAPTURE,
     CALLBACK_MODE_VERSION_BUGCHECK,
     CALLBACK_MODE_VERSION_CREATE_OPEN_V1,
+    CALLBACK_MODE_KEY_OBJECT_FILTER,
+    CALLBACK_MODE_CAPTURE_LOG,
 } CALLBACK_MODE;
 
 
@@ -104,6 +107,7 @@ typedef enum _KERNELMODE_SAMPLE {
     KERNELMODE_SAMPLE_SET_CALL_CONTEXT,
     KERNELMODE_SAMPLE_SET_OBJECT_CONTEXT,
     KERNELMODE_SAMPLE_VERSION_CREATE_OPEN_V1,
+    KERNELMODE_SAMPLE_KEY_OBJECT_FILTER,
     MAX_KERNELMODE_SAMPLES
 } KERNELMODE_SAMPLE;
 
@@ -166,3 +170,136 @@ typedef struct _DO_KERNELMODE_SAMPLES_OUTPUT {
 } DO_KERNELMODE_SAMPLES_OUTPUT, *PDO_KERNELMODE_SAMPLES_OUTPUT;
 
 
+typedef struct _MAP_CAPTURE_LOG_INPUT {
+
+    //
+    // specifies the cookie of a callback registered with
+    // CALLBACK_MODE_CAPTURE_LOG
+    //
+    LARGE_INTEGER Cookie;
+
+} MAP_CAPTURE_LOG_INPUT, *PMAP_CAPTURE_LOG_INPUT;
+
+typedef struct _MAP_CAPTURE_LOG_OUTPUT {
+
+    //
+    // receives the address of the capture log in the calling process and
+    // the size of the view. The view is unmapped with UnmapViewOfFile.
+    //
+    ULONG64 ViewBase;
+    ULONG64 ViewSize;
+
+} MAP_CAPTURE_LOG_OUTPUT, *PMAP_CAPTURE_LOG_OUTPUT;
+
+
+//
+// Layout of the capture log section shared by the driver and regctrl.
+//
+// The section starts with a CAPTURE_LOG_HEADER, followed by a ring of
+// CAPTURE_LOG_RECORD_COUNT fixed size records and then by an arena of
+// CAPTURE_LOG_ARENA_SIZE bytes holding the names and data of the records.
+//
+// Positions in the ring and in the arena only grow; the slot of a position
+// is the position modulo the size. The driver writes a record and its
+// arena bytes and then publishes the record by setting its Sequence to the
+// position plus one. The consumer reads the published records from
+// RecordTail on, then advances ArenaTail and RecordTail past them. When the
+// consumer falls behind the driver drops operations and counts them in
+// Dropped instead of overwriting records it has not read yet.
+//
+
+#define CAPTURE_LOG_RECORD_COUNT        4096
+#define CAPTURE_LOG_ARENA_SIZE          (1024 * 1024)
+
+//
+// At most this many bytes of value data are copied for a record.
+//
+#define CAPTURE_LOG_MAX_DATA_LENGTH     256
+
+//
+// Record flags
+//
+#define CAPTURE_LOG_FLAG_TRUNCATED      0x1
+#define CAPTURE_LOG_FLAG_FAULTED        0x2
+
+//
+// Operations logged
+//
+typedef enum _CAPTURE_LOG_OPERATION {
+    CAPTURE_LOG_OPERATION_CREATE_KEY,
+    CAPTURE_LOG_OPERATION_OPEN_KEY,
+    CAPTURE_LOG_OPERATION_DELETE_KEY,
+    CAPTURE_LOG_OPERATION_SET_VALUE,
+    CAPTURE_LOG_OPERATION_DELETE_VALUE,
+    CAPTURE_LOG_OPERATION_QUERY_VALUE,
+    MAX_CAPTURE_LOG_OPERATIONS
+} CAPTURE_LOG_OPERATION;
+
+typedef struct _CAPTURE_LOG_RECORD {
+
+    //
+    // position of the record plus one, truncated to 32 bits, once the
+    // record is complete
+    //
+    volatile ULONG Sequence;
+
+    //
+    // CAPTURE_LOG_OPERATION of the record
+    //
+    ULONG Operation;
+
+    ULONG ThreadId;
+    ULONG Flags;
+
+    //
+    // value of KeQueryPerformanceCounter when the operation was logged
+    //
+    LONG64 Timestamp;
+
+    //
+    // position in the arena of the name, immediately followed by the data
+    //
+    ULONG64 ArenaPosition;
+
+    //
+    // length in bytes of the key or value name
+    //
+    ULONG NameLength;
+
+    //
+    // type of the value, and the bytes of its data that were copied and
+    // the length the caller passed
+    //
+    ULONG Type;
+    ULONG DataLength;
+    ULONG DataSize;
+
+} CAPTURE_LOG_RECORD, *PCAPTURE_LOG_RECORD;
+
+typedef struct _CAPTURE_LOG_HEADER {
+
+    ULONG RecordCount;
+    ULONG ArenaSize;
+
+    //
+    // offsets from the start of the header to the ring and to the arena
+    //
+    ULONG RecordsOffset;
+    ULONG ArenaOffset;
+
+    //
+    // written by the driver
+    //
+    volatile LONG64 RecordHead;
+    volatile LONG64 Dropped;
+    LONG64 PerformanceFrequency;
+
+    //
+    // written by the consumer, on a cache line of their own
+    //
+    DECLSPEC_ALIGN(64) volatile LONG64 RecordTail;
+    volatile LONG64 ArenaTail;
+
+} CAPTURE_LOG_HEADER, *PCAPTURE_LOG_HEADER;
+
+
@@ -182,6 +182,7 @@ Routine Description:
     PostNotificationOverrideSuccessSample();
     PostNotificationOverrideErrorSample();
     CaptureSample();
+    CaptureLogSample();
 
   Exit:
     
@@ -281,6 +282,8 @@ Return Value:
             return L"Set Object Context Sample";
         case KERNELMODE_SAMPLE_VERSION_CREATE_OPEN_V1:
             return L"Create Open V1 Sample";
+        case KERNELMODE_SAMPLE_KEY_OBJECT_FILTER:
+            return L"Key Object Filter Sample";
         default:
             return L"Unsupported Kernel Mode Sample";
     }
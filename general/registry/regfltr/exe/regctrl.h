@@ -86,6 +86,9 @@ PostNotificationOverrideErrorSample();
 VOID
 CaptureSample();
 
+VOID
+CaptureLogSample();
+
 //
 // Utility routines to load and unload the driver
 //
@@ -0,0 +1,593 @@
+/*++
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    CaptureLog.c
+
+Abstract:
+
+    Sample that shows how to log registry operations in bulk. Instead of
+    allocating a captured copy of each parameter, the callback appends a
+    fixed size record to a ring and copies the names and data into an
+    arena. Both live in a section that regctrl maps into its own address
+    space and drains without a call into the driver per operation.
+
+    The layout of the section is described in common.h.
+
+Environment:
+
+    Kernel mode only
+
+--*/
+
+#include "regfltr.h"
+
+
+//
+// Offsets of the ring and of the arena in the section.
+//
+
+#define CAPTURE_LOG_RECORDS_OFFSET                                          \
+    ((ULONG) ((sizeof(CAPTURE_LOG_HEADER) + 63) & ~63))
+
+#define CAPTURE_LOG_ARENA_OFFSET                                            \
+    (CAPTURE_LOG_RECORDS_OFFSET +                                           \
+     (ULONG) (CAPTURE_LOG_RECORD_COUNT * sizeof(CAPTURE_LOG_RECORD)))
+
+#define CAPTURE_LOG_SECTION_SIZE                                            \
+    (CAPTURE_LOG_ARENA_OFFSET + CAPTURE_LOG_ARENA_SIZE)
+
+//
+// Arena bytes are reserved in multiples of 8 so the name of every record
+// starts aligned.
+//
+
+#define CAPTURE_LOG_ALIGN(Length)   (((Length) + 7) & ~7)
+
+C_ASSERT((CAPTURE_LOG_RECORD_COUNT & (CAPTURE_LOG_RECORD_COUNT - 1)) == 0);
+C_ASSERT((CAPTURE_LOG_ARENA_SIZE & (CAPTURE_LOG_ARENA_SIZE - 1)) == 0);
+
+//
+// The largest reservation, a name of MAXUSHORT bytes with the maximum
+// amount of data, has to fit in the arena.
+//
+
+C_ASSERT(CAPTURE_LOG_ALIGN(MAXUSHORT + CAPTURE_LOG_MAX_DATA_LENGTH) <= CAPTURE_LOG_ARENA_SIZE);
+
+
+NTSTATUS
+CreateCaptureLog(
+    _Outptr_ PCAPTURE_LOG *CaptureLog
+    )
+/*++
+
+Routine Description:
+
+    Creates the capture log section and maps it into system space. The
+    section is backed by the paging file; the callback only touches it at
+    PASSIVE_LEVEL or APC_LEVEL.
+
+Arguments:
+
+    CaptureLog - receives the capture log. Free it with DeleteCaptureLog.
+
+Return Value:
+
+    NTSTATUS
+
+--*/
+{
+    NTSTATUS Status;
+    PCAPTURE_LOG Log;
+    OBJECT_ATTRIBUTES SectionAttributes;
+    LARGE_INTEGER SectionSize;
+    SIZE_T ViewSize = 0;
+    LARGE_INTEGER Frequency;
+
+    *CaptureLog = NULL;
+
+    Log = (PCAPTURE_LOG) ExAllocatePoolWithTag(NonPagedPoolNx,
+                                               sizeof(CAPTURE_LOG),
+                                               REGFLTR_CAPTURE_LOG_POOL_TAG);
+
+    if (Log == NULL) {
+        ErrorPrint("CreateCaptureLog failed due to insufficient resources.");
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(Log, sizeof(CAPTURE_LOG));
+    ExInitializeFastMutex(&Log->Lock);
+
+    InitializeObjectAttributes(&SectionAttributes,
+                               NULL,
+                               OBJ_KERNEL_HANDLE,
+                               NULL,
+                               NULL);
+
+    SectionSize.QuadPart = CAPTURE_LOG_SECTION_SIZE;
+
+    Status = ZwCreateSection(&Log->Section,
+                             SECTION_ALL_ACCESS,
+                             &SectionAttributes,
+                             &SectionSize,
+                             PAGE_READWRITE,
+                             SEC_COMMIT,
+                             NULL);
+
+    if (!NT_SUCCESS(Status)) {
+        ErrorPrint("ZwCreateSection failed. Status 0x%x", Status);
+        goto Exit;
+    }
+
+    Status = ObReferenceObjectByHandle(Log->Section,
+                                       SECTION_MAP_READ | SECTION_MAP_WRITE,
+                                       *MmSectionObjectType,
+                                       KernelMode,
+                                       &Log->SectionObject,
+                                       NULL);
+
+    if (!NT_SUCCESS(Status)) {
+        ErrorPrint("ObReferenceObjectByHandle failed. Status 0x%x", Status);
+        goto Exit;
+    }
+
+    Status = MmMapViewInSystemSpace(Log->SectionObject,
+                                    (PVOID *) &Log->Header,
+                                    &ViewSize);
+
+    if (!NT_SUCCESS(Status)) {
+        ErrorPrint("MmMapViewInSystemSpace failed. Status 0x%x", Status);
+        Log->Header = NULL;
+        goto Exit;
+    }
+
+    Log->Records = (PCAPTURE_LOG_RECORD) ((PUCHAR) Log->Header + CAPTURE_LOG_RECORDS_OFFSET);
+    Log->Arena = (PUCHAR) Log->Header + CAPTURE_LOG_ARENA_OFFSET;
+
+    //
+    // A new section is zero filled, so every record starts out unpublished
+    // and all positions at 0.
+    //
+
+    KeQueryPerformanceCounter(&Frequency);
+
+    Log->Header->RecordCount = CAPTURE_LOG_RECORD_COUNT;
+    Log->Header->ArenaSize = CAPTURE_LOG_ARENA_SIZE;
+    Log->Header->RecordsOffset = CAPTURE_LOG_RECORDS_OFFSET;
+    Log->Header->ArenaOffset = CAPTURE_LOG_ARENA_OFFSET;
+    Log->Header->PerformanceFrequency = Frequency.QuadPart;
+
+    *CaptureLog = Log;
+
+  Exit:
+
+    if (!NT_SUCCESS(Status)) {
+        DeleteCaptureLog(Log);
+    }
+
+    return Status;
+}
+
+
+VOID
+DeleteCaptureLog(
+    _In_ PCAPTURE_LOG CaptureLog
+    )
+/*++
+
+Routine Description:
+
+    Unmaps the system space view of a capture log and closes the section.
+    The callback must already be unregistered. Views mapped into user mode
+    stay valid until the process unmaps them or exits.
+
+Arguments:
+
+    CaptureLog - the capture log.
+
+--*/
+{
+    if (CaptureLog->Header != NULL) {
+        MmUnmapViewInSystemSpace(CaptureLog->Header);
+    }
+
+    if (CaptureLog->SectionObject != NULL) {
+        ObDereferenceObject(CaptureLog->SectionObject);
+    }
+
+    if (CaptureLog->Section != NULL) {
+        ZwClose(CaptureLog->Section);
+    }
+
+    ExFreePoolWithTag(CaptureLog, REGFLTR_CAPTURE_LOG_POOL_TAG);
+}
+
+
+VOID
+CaptureLogAppend(
+    _In_ PCAPTURE_LOG CaptureLog,
+    _In_ CAPTURE_LOG_OPERATION Operation,
+    _In_opt_ PCUNICODE_STRING Name,
+    _In_ ULONG Type,
+    _In_reads_bytes_opt_(DataSize) PVOID Data,
+    _In_ ULONG DataSize
+    )
+/*++
+
+Routine Description:
+
+    Appends a record to the capture log. The lock is only held to reserve
+    the record and its arena bytes; the copies are done after it is
+    released and the record is published last.
+
+    When the ring or the arena is full the operation is counted as dropped.
+
+Arguments:
+
+    CaptureLog - the capture log.
+
+    Operation - the type of the operation.
+
+    Name - the key or value name of the operation, if it has one.
+
+    Type, Data, DataSize - the value type and data of a set value operation.
+
+--*/
+{
+    PCAPTURE_LOG_HEADER Header = CaptureLog->Header;
+    PCAPTURE_LOG_RECORD Record;
+    PUCHAR Destination;
+    ULONG64 RecordPosition;
+    ULONG64 ArenaPosition = 0;
+    ULONG ArenaOffset;
+    ULONG NameLength;
+    ULONG DataLength;
+    ULONG Length;
+    ULONG Flags = 0;
+    BOOLEAN Reserved = FALSE;
+
+    NameLength = (Name != NULL) ? Name->Length : 0;
+    DataLength = (Data != NULL) ? DataSize : 0;
+
+    if (DataLength > CAPTURE_LOG_MAX_DATA_LENGTH) {
+        DataLength = CAPTURE_LOG_MAX_DATA_LENGTH;
+        Flags |= CAPTURE_LOG_FLAG_TRUNCATED;
+    }
+
+    Length = CAPTURE_LOG_ALIGN(NameLength + DataLength);
+
+    //
+    // Reserve a record and the arena bytes. RecordTail and ArenaTail are
+    // written by the consumer; they are only used to decide whether there
+    // is room, the positions written to come from CaptureLog.
+    //
+
+    ExAcquireFastMutex(&CaptureLog->Lock);
+
+    RecordPosition = CaptureLog->RecordHead;
+
+    if (RecordPosition - (ULONG64) Header->RecordTail < CAPTURE_LOG_RECORD_COUNT) {
+
+        //
+        // Names and data are never split across the end of the arena. If
+        // they don't fit before it, the rest of the lap is skipped.
+        //
+
+        ArenaPosition = CaptureLog->ArenaHead;
+        ArenaOffset = (ULONG) (ArenaPosition & (CAPTURE_LOG_ARENA_SIZE - 1));
+
+        if (ArenaOffset + Length > CAPTURE_LOG_ARENA_SIZE) {
+            ArenaPosition += CAPTURE_LOG_ARENA_SIZE - ArenaOffset;
+        }
+
+        if (ArenaPosition + Length - (ULONG64) Header->ArenaTail <= CAPTURE_LOG_ARENA_SIZE) {
+            CaptureLog->RecordHead = RecordPosition + 1;
+            CaptureLog->ArenaHead = ArenaPosition + Length;
+            Header->RecordHead = (LONG64) CaptureLog->RecordHead;
+            Reserved = TRUE;
+        }
+    }
+
+    if (!Reserved) {
+        Header->Dropped += 1;
+    }
+
+    ExReleaseFastMutex(&CaptureLog->Lock);
+
+    if (!Reserved) {
+        return;
+    }
+
+    //
+    // Copy the name and the data. Before Windows 8 the value name and data
+    // of some operations from user mode are not captured by the registry,
+    // so the copy can fault.
+    //
+
+    Destination = CaptureLog->Arena + (ArenaPosition & (CAPTURE_LOG_ARENA_SIZE - 1));
+
+    try {
+        if (NameLength != 0) {
+            RtlCopyMemory(Destination, Name->Buffer, NameLength);
+        }
+        if (DataLength != 0) {
+            RtlCopyMemory(Destination + NameLength, Data, DataLength);
+        }
+    } except (ExceptionFilter(GetExceptionInformation())) {
+        ErrorPrint("Copying into the capture log failed with exception");
+        NameLength = 0;
+        DataLength = 0;
+        Flags |= CAPTURE_LOG_FLAG_FAULTED;
+    }
+
+    Record = &CaptureLog->Records[RecordPosition & (CAPTURE_LOG_RECORD_COUNT - 1)];
+
+    Record->Operation = (ULONG) Operation;
+    Record->ThreadId = HandleToULong(PsGetCurrentThreadId());
+    Record->Flags = Flags;
+    Record->Timestamp = KeQueryPerformanceCounter(NULL).QuadPart;
+    Record->ArenaPosition = ArenaPosition;
+    Record->NameLength = NameLength;
+    Record->Type = Type;
+    Record->DataLength = DataLength;
+    Record->DataSize = DataSize;
+
+    //
+    // Publish the record. The interlocked operation is a full barrier, so
+    // the consumer sees the fields above once it sees the sequence.
+    //
+
+    InterlockedExchange((volatile LONG *) &Record->Sequence,
+                        (LONG) (ULONG) (RecordPosition + 1));
+}
+
+
+NTSTATUS
+CallbackCaptureLog(
+    _In_ PCALLBACK_CONTEXT CallbackCtx,
+    _In_ REG_NOTIFY_CLASS NotifyClass,
+    _Inout_ PVOID Argument2
+    )
+/*++
+
+Routine Description:
+
+    This helper callback routine logs the pre-notifications of key create,
+    open and delete and of value set, query and delete operations into the
+    capture log. It never changes the outcome of an operation.
+
+    Operations that happen before regctrl maps the log are not logged.
+
+Arguments:
+
+    CallbackContext - The value that the driver passed to the Context parameter
+        of CmRegisterCallbackEx when it registers this callback routine.
+
+    NotifyClass - A REG_NOTIFY_CLASS typed value that identifies the type of
+        registry operation that is being performed and whether the callback
+        is being called in the pre or post phase of processing.
+
+    Argument2 - A pointer to a structure that contains information specific
+        to the type of the registry operation. The structure type depends
+        on the REG_NOTIFY_CLASS value of Argument1.
+
+Return Value:
+
+    Always STATUS_SUCCESS
+
+--*/
+{
+    PCAPTURE_LOG CaptureLog;
+    PREG_CREATE_KEY_INFORMATION PreCreateInfo;
+    PREG_OPEN_KEY_INFORMATION PreOpenInfo;
+    PREG_SET_VALUE_KEY_INFORMATION PreSetValueInfo;
+    PREG_DELETE_VALUE_KEY_INFORMATION PreDeleteValueInfo;
+    PREG_QUERY_VALUE_KEY_INFORMATION PreQueryValueInfo;
+
+    CaptureLog = (PCAPTURE_LOG) ReadPointerAcquire((PVOID volatile *) &CallbackCtx->CaptureLog);
+
+    if (CaptureLog == NULL) {
+        return STATUS_SUCCESS;
+    }
+
+    switch(NotifyClass) {
+        case RegNtPreCreateKeyEx:
+            PreCreateInfo = (PREG_CREATE_KEY_INFORMATION) Argument2;
+            CaptureLogAppend(CaptureLog,
+                             CAPTURE_LOG_OPERATION_CREATE_KEY,
+                             PreCreateInfo->CompleteName,
+                             REG_NONE,
+                             NULL,
+                             0);
+            break;
+
+        case RegNtPreOpenKeyEx:
+            PreOpenInfo = (PREG_OPEN_KEY_INFORMATION) Argument2;
+            CaptureLogAppend(CaptureLog,
+                             CAPTURE_LOG_OPERATION_OPEN_KEY,
+                             PreOpenInfo->CompleteName,
+                             REG_NONE,
+                             NULL,
+                             0);
+            break;
+
+        case RegNtPreDeleteKey:
+            CaptureLogAppend(CaptureLog,
+                             CAPTURE_LOG_OPERATION_DELETE_KEY,
+                             NULL,
+                             REG_NONE,
+                             NULL,
+                             0);
+            break;
+
+        case RegNtPreSetValueKey:
+            PreSetValueInfo = (PREG_SET_VALUE_KEY_INFORMATION) Argument2;
+            CaptureLogAppend(CaptureLog,
+                             CAPTURE_LOG_OPERATION_SET_VALUE,
+                             PreSetValueInfo->ValueName,
+                             PreSetValueInfo->Type,
+                             PreSetValueInfo->Data,
+                             PreSetValueInfo->DataSize);
+            break;
+
+        case RegNtPreDeleteValueKey:
+            PreDeleteValueInfo = (PREG_DELETE_VALUE_KEY_INFORMATION) Argument2;
+            CaptureLogAppend(CaptureLog,
+                             CAPTURE_LOG_OPERATION_DELETE_VALUE,
+                             PreDeleteValueInfo->ValueName,
+                             REG_NONE,
+                             NULL,
+                             0);
+            break;
+
+        case RegNtPreQueryValueKey:
+            PreQueryValueInfo = (PREG_QUERY_VALUE_KEY_INFORMATION) Argument2;
+            CaptureLogAppend(CaptureLog,
+                             CAPTURE_LOG_OPERATION_QUERY_VALUE,
+                             PreQueryValueInfo->ValueName,
+                             REG_NONE,
+                             NULL,
+                             0);
+            break;
+
+        default:
+            //
+            // Do nothing for other notifications
+            //
+            break;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+MapCaptureLog(
+    _In_ PDEVICE_OBJECT DeviceObject,
+    _In_ PIRP Irp
+    )
+/*++
+
+Routine Description:
+
+    Maps the capture log of a callback into the calling process, creating
+    the log the first time. Only the process that registered the callback
+    may map its log.
+
+Arguments:
+
+    DeviceObject - The device object receiving the request.
+
+    Irp - The request packet.
+
+Return Value:
+
+    NTSTATUS
+
+--*/
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    PIO_STACK_LOCATION IrpStack;
+    ULONG InputBufferLength;
+    ULONG OutputBufferLength;
+    PMAP_CAPTURE_LOG_INPUT MapCaptureLogInput;
+    PMAP_CAPTURE_LOG_OUTPUT MapCaptureLogOutput;
+    LARGE_INTEGER Cookie;
+    PCALLBACK_CONTEXT CallbackCtx;
+    PCAPTURE_LOG CaptureLog = NULL;
+    PVOID ViewBase = NULL;
+    SIZE_T ViewSize = 0;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    //
+    // Get the input and output buffer from the irp and
+    // check they are the expected size
+    //
+
+    IrpStack = IoGetCurrentIrpStackLocation(Irp);
+
+    InputBufferLength  = IrpStack->Parameters.DeviceIoControl.InputBufferLength;
+    OutputBufferLength = IrpStack->Parameters.DeviceIoControl.OutputBufferLength;
+
+    if ((InputBufferLength < sizeof(MAP_CAPTURE_LOG_INPUT)) ||
+       (OutputBufferLength < sizeof (MAP_CAPTURE_LOG_OUTPUT))) {
+        Status = STATUS_INVALID_PARAMETER;
+        goto Exit;
+    }
+
+    MapCaptureLogInput = (PMAP_CAPTURE_LOG_INPUT) Irp->AssociatedIrp.SystemBuffer;
+    Cookie = MapCaptureLogInput->Cookie;
+
+    CallbackCtx = FindCallbackContext(Cookie);
+
+    if ((CallbackCtx == NULL) ||
+        (CallbackCtx->Cookie.QuadPart != Cookie.QuadPart) ||
+        (CallbackCtx->CallbackMode != CALLBACK_MODE_CAPTURE_LOG) ||
+        (CallbackCtx->ProcessId != PsGetCurrentProcessId())) {
+        Status = STATUS_INVALID_PARAMETER;
+        goto Exit;
+    }
+
+    //
+    // Create the log if the callback doesn't have one yet. If another
+    // thread set one first, use that one instead.
+    //
+
+    if (CallbackCtx->CaptureLog == NULL) {
+
+        Status = CreateCaptureLog(&CaptureLog);
+
+        if (!NT_SUCCESS(Status)) {
+            goto Exit;
+        }
+
+        if (InterlockedCompareExchangePointer((PVOID volatile *) &CallbackCtx->CaptureLog,
+                                              CaptureLog,
+                                              NULL) != NULL) {
+            DeleteCaptureLog(CaptureLog);
+        }
+    }
+
+    //
+    // Map a view of the section into the calling process. The system
+    // unmaps it when the process exits if regctrl doesn't do it first.
+    //
+
+    Status = ZwMapViewOfSection(CallbackCtx->CaptureLog->Section,
+                                ZwCurrentProcess(),
+                                &ViewBase,
+                                0,
+                                0,
+                                NULL,
+                                &ViewSize,
+                                ViewUnmap,
+                                0,
+                                PAGE_READWRITE);
+
+    if (!NT_SUCCESS(Status)) {
+        ErrorPrint("ZwMapViewOfSection failed. Status 0x%x", Status);
+        goto Exit;
+    }
+
+    MapCaptureLogOutput = (PMAP_CAPTURE_LOG_OUTPUT) Irp->AssociatedIrp.SystemBuffer;
+    MapCaptureLogOutput->ViewBase = (ULONG64) (ULONG_PTR) ViewBase;
+    MapCaptureLogOutput->ViewSize = (ULONG64) ViewSize;
+    Irp->IoStatus.Information = sizeof(MAP_CAPTURE_LOG_OUTPUT);
+
+  Exit:
+
+    if (!NT_SUCCESS(Status)) {
+        ErrorPrint("MapCaptureLog failed. Status 0x%x", Status);
+    } else {
+        InfoPrint("MapCaptureLog succeeded");
+    }
+
+    return Status;
+}
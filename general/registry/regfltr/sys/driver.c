@@ -400,6 +400,10 @@ Return Value:
         Status = GetCallbackVersion(DeviceObject, Irp);
         break;
 
+    case IOCTL_MAP_CAPTURE_LOG:
+        Status = MapCaptureLog(DeviceObject, Irp);
+        break;
+
     default:
         ErrorPrint("Unrecognized ioctl code 0x%x", Ioctl);
     }
@@ -0,0 +1,609 @@
+/*++
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    KeyFilter.c
+
+Abstract:
+
+    Sample that shows how a filter can decide on a key object once and
+    cache the decision as the object context, instead of resolving and
+    comparing the key name in every callback.
+
+Environment:
+
+    Kernel mode only
+
+--*/
+
+#include "regfltr.h"
+
+
+//
+// Number of set value operations done on each key in the sample.
+//
+
+#define KEY_FILTER_SAMPLE_OPERATIONS    64
+
+
+//
+// The decision cached for a key object. The object context of a key
+// object points at one of the two entries of KeyFilterDecisions.
+//
+
+typedef struct _KEY_FILTER_DECISION {
+    BOOLEAN Block;
+} KEY_FILTER_DECISION, *PKEY_FILTER_DECISION;
+
+KEY_FILTER_DECISION KeyFilterDecisions[2] = { { FALSE }, { TRUE } };
+
+#define KEY_FILTER_ALLOW    (&KeyFilterDecisions[0])
+#define KEY_FILTER_BLOCK    (&KeyFilterDecisions[1])
+
+
+//
+// The protected paths. The lengths of the strings are computed at compile
+// time, so a lookup is only a case-insensitive prefix comparison per entry.
+// A subtree entry also matches every key below the path.
+//
+
+typedef struct _KEY_FILTER_PATH {
+    UNICODE_STRING Path;
+    BOOLEAN Subtree;
+} KEY_FILTER_PATH, *PKEY_FILTER_PATH;
+
+const KEY_FILTER_PATH KeyFilterPaths[] = {
+    { RTL_CONSTANT_STRING(ROOT_KEY_ABS_PATH L"\\" KEY_NAME), TRUE },
+};
+
+
+VOID
+KeyFilterCount(
+    _In_ PCALLBACK_CONTEXT CallbackCtx,
+    _In_ KEY_FILTER_COUNTER Counter
+    )
+/*++
+
+Routine Description:
+
+    Adds one to a counter of the current processor. The IRQL is raised so
+    the thread cannot move to another processor, or be preempted by another
+    thread updating the same copy, between reading and writing it.
+
+--*/
+{
+    KIRQL OldIrql;
+
+    KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+    CallbackCtx->KeyFilterCounters[KeGetCurrentProcessorIndex()].Counters[Counter] += 1;
+    KeLowerIrql(OldIrql);
+}
+
+
+PKEY_FILTER_DECISION
+KeyFilterLookupPath(
+    _In_ PCUNICODE_STRING KeyName
+    )
+/*++
+
+Routine Description:
+
+    Matches an absolute key name against the protected paths.
+
+--*/
+{
+    ULONG Index;
+    PCUNICODE_STRING Path;
+
+    for (Index = 0; Index < RTL_NUMBER_OF(KeyFilterPaths); Index++) {
+
+        Path = &KeyFilterPaths[Index].Path;
+
+        if (!RtlPrefixUnicodeString(Path, KeyName, TRUE)) {
+            continue;
+        }
+
+        if (KeyName->Length == Path->Length) {
+            return KEY_FILTER_BLOCK;
+        }
+
+        if (KeyFilterPaths[Index].Subtree &&
+            KeyName->Buffer[Path->Length / sizeof(WCHAR)] == L'\\') {
+            return KEY_FILTER_BLOCK;
+        }
+    }
+
+    return KEY_FILTER_ALLOW;
+}
+
+
+PKEY_FILTER_DECISION
+KeyFilterGetDecision(
+    _In_ PCALLBACK_CONTEXT CallbackCtx,
+    _In_ PVOID Object,
+    _In_opt_ PVOID ObjectContext
+    )
+/*++
+
+Routine Description:
+
+    Returns the decision for a key object. If the object already carries a
+    decision as its object context, that is the answer. Otherwise the key
+    name is resolved and looked up once, and the decision is set as the
+    object context so the following operations on the object take the fast
+    path.
+
+    If the name cannot be resolved the operation is allowed and nothing is
+    cached, so the next operation tries again.
+
+Arguments:
+
+    CallbackCtx - The callback context.
+
+    Object - The key object of the operation.
+
+    ObjectContext - The object context the registry passed for Object.
+
+Return Value:
+
+    The decision for the key.
+
+--*/
+{
+    PKEY_FILTER_DECISION Decision;
+    PCUNICODE_STRING KeyName;
+    NTSTATUS Status;
+
+    if (ObjectContext == KEY_FILTER_ALLOW || ObjectContext == KEY_FILTER_BLOCK) {
+        KeyFilterCount(CallbackCtx, KeyFilterContextHits);
+        return (PKEY_FILTER_DECISION) ObjectContext;
+    }
+
+#if (NTDDI_VERSION >= NTDDI_WIN8)
+
+    Status = CmCallbackGetKeyObjectIDEx(&CallbackCtx->Cookie,
+                                        Object,
+                                        NULL,
+                                        &KeyName,
+                                        0);
+
+#else
+
+    Status = CmCallbackGetKeyObjectID(&CallbackCtx->Cookie,
+                                      Object,
+                                      NULL,
+                                      &KeyName);
+
+#endif //NTDDI_VERSION >= NTDDI_WIN8
+
+    if (!NT_SUCCESS(Status)) {
+        ErrorPrint("CmCallbackGetKeyObjectID failed. Status 0x%x", Status);
+        return KEY_FILTER_ALLOW;
+    }
+
+    KeyFilterCount(CallbackCtx, KeyFilterNamesResolved);
+
+    Decision = KeyFilterLookupPath(KeyName);
+
+    InfoPrint("\tCallback: Key %wZ resolved, %s.",
+              KeyName,
+              Decision->Block ? "blocked" : "allowed");
+
+#if (NTDDI_VERSION >= NTDDI_WIN8)
+    CmCallbackReleaseKeyObjectIDEx(KeyName);
+#endif //NTDDI_VERSION >= NTDDI_WIN8
+
+    //
+    // Cache the decision on the key object. The context is a pointer to a
+    // global, so there is nothing to free when it is cleaned up.
+    //
+
+    Status = CmSetCallbackObjectContext(Object,
+                                        &CallbackCtx->Cookie,
+                                        Decision,
+                                        NULL);
+
+    if (!NT_SUCCESS(Status)) {
+        ErrorPrint("CmSetCallbackObjectContext failed. Status 0x%x", Status);
+    }
+
+    return Decision;
+}
+
+
+BOOLEAN
+KeyObjectFilterSample(
+    )
+/*++
+
+Routine Description:
+
+    This sample shows how to filter on the key object instead of the key
+    name. The callback resolves the name of a key the first time it sees
+    the key object, looks it up in a table of protected paths, and caches
+    the decision as the object context. Later operations on the same
+    object are decided without resolving the name again.
+
+    Two keys are created, one of them protected, and values are set many
+    times through both handles and through g_RootKey. g_RootKey was opened
+    before the callback was registered, so its decision is cached on its
+    first operation instead of at open time.
+
+Return Value:
+
+    TRUE if the sample completed successfully.
+
+--*/
+{
+    PCALLBACK_CONTEXT CallbackCtx = NULL;
+    LONG64 Counters[KeyFilterCounterCount] = {0};
+    ULONG Counter;
+    SIZE_T CountersSize;
+    ULONG Index;
+    NTSTATUS Status;
+    OBJECT_ATTRIBUTES KeyAttributes;
+    UNICODE_STRING Name;
+    HANDLE Key = NULL;
+    HANDLE NotModifiedKey = NULL;
+    ULONG Operation;
+    DWORD ValueData = 0;
+    BOOLEAN Success = FALSE;
+
+    InfoPrint("");
+    InfoPrint("=== Key Object Filter Sample ====");
+
+    //
+    // Create the callback context and its per-processor counters
+    //
+
+    CallbackCtx = CreateCallbackContext(CALLBACK_MODE_KEY_OBJECT_FILTER,
+                                        CALLBACK_ALTITUDE);
+    if (CallbackCtx == NULL) {
+        goto Exit;
+    }
+
+    CallbackCtx->KeyFilterProcessorCount =
+        KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    CountersSize = (SIZE_T) CallbackCtx->KeyFilterProcessorCount *
+                   sizeof(KEY_FILTER_COUNTERS);
+
+    CallbackCtx->KeyFilterCounters = (PKEY_FILTER_COUNTERS) ExAllocatePoolWithTag (
+                        NonPagedPoolNxCacheAligned,
+                        CountersSize,
+                        REGFLTR_CONTEXT_POOL_TAG);
+
+    if (CallbackCtx->KeyFilterCounters == NULL) {
+        ErrorPrint("KeyObjectFilterSample failed due to insufficient resources.");
+        goto Exit;
+    }
+
+    RtlZeroMemory(CallbackCtx->KeyFilterCounters, CountersSize);
+
+    //
+    // Register callback
+    //
+
+    Status = CmRegisterCallbackEx(Callback,
+                                  &CallbackCtx->Altitude,
+                                  g_DeviceObj->DriverObject,
+                                  (PVOID) CallbackCtx,
+                                  &CallbackCtx->Cookie,
+                                  NULL);
+    if (!NT_SUCCESS(Status)) {
+        ErrorPrint("CmRegisterCallback failed. Status 0x%x", Status);
+        goto Exit;
+    }
+
+    Success = TRUE;
+
+    //
+    // Create the protected key and the "not modified" key. The callback
+    // decides on each of them in the post-create notification.
+    //
+
+    RtlInitUnicodeString(&Name, KEY_NAME);
+    InitializeObjectAttributes(&KeyAttributes,
+                               &Name,
+                               OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                               g_RootKey,
+                               NULL);
+
+    Status = ZwCreateKey(&Key,
+                         KEY_ALL_ACCESS,
+                         &KeyAttributes,
+                         0,
+                         NULL,
+                         0,
+                         NULL);
+
+    if (!NT_SUCCESS(Status)) {
+        ErrorPrint("ZwCreateKey failed. Status 0x%x", Status);
+        Success = FALSE;
+    }
+
+    RtlInitUnicodeString(&Name, NOT_MODIFIED_KEY_NAME);
+    InitializeObjectAttributes(&KeyAttributes,
+                               &Name,
+                               OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                               g_RootKey,
+                               NULL);
+
+    Status = ZwCreateKey(&NotModifiedKey,
+                         KEY_ALL_ACCESS,
+                         &KeyAttributes,
+                         0,
+                         NULL,
+                         0,
+                         NULL);
+
+    if (!NT_SUCCESS(Status)) {
+        ErrorPrint("ZwCreateKey failed. Status 0x%x", Status);
+        Success = FALSE;
+    }
+
+    //
+    // Set values through the three handles. Only the protected key is
+    // blocked.
+    //
+
+    RtlInitUnicodeString(&Name, VALUE_NAME);
+
+    for (Operation = 0; Operation < KEY_FILTER_SAMPLE_OPERATIONS; Operation++) {
+
+        if (Key != NULL) {
+            Status = ZwSetValueKey(Key,
+                                   &Name,
+                                   0,
+                                   REG_DWORD,
+                                   &ValueData,
+                                   sizeof(ValueData));
+
+            if (Status != STATUS_ACCESS_DENIED) {
+                ErrorPrint("ZwSetValue return unexpected status 0x%x", Status);
+                Success = FALSE;
+            }
+        }
+
+        if (NotModifiedKey != NULL) {
+            Status = ZwSetValueKey(NotModifiedKey,
+                                   &Name,
+                                   0,
+                                   REG_DWORD,
+                                   &ValueData,
+                                   sizeof(ValueData));
+
+            if (Status != STATUS_SUCCESS) {
+                ErrorPrint("ZwSetValue return unexpected status 0x%x", Status);
+                Success = FALSE;
+            }
+        }
+
+        Status = ZwSetValueKey(g_RootKey,
+                               &Name,
+                               0,
+                               REG_DWORD,
+                               &ValueData,
+                               sizeof(ValueData));
+
+        if (Status != STATUS_SUCCESS) {
+            ErrorPrint("ZwSetValue return unexpected status 0x%x", Status);
+            Success = FALSE;
+        }
+    }
+
+    //
+    // Delete the values again while the callback is registered; the
+    // decisions are still cached.
+    //
+
+    if (NotModifiedKey != NULL) {
+        ZwDeleteValueKey(NotModifiedKey, &Name);
+    }
+
+    ZwDeleteValueKey(g_RootKey, &Name);
+
+    //
+    // Unregister the callback. This cleans up the object contexts that are
+    // still set, here the ones of the three handles.
+    //
+
+    Status = CmUnRegisterCallback(CallbackCtx->Cookie);
+
+    if (!NT_SUCCESS(Status)) {
+        ErrorPrint("CmUnRegisterCallback failed. Status 0x%x", Status);
+        Success = FALSE;
+    }
+
+    //
+    // Sum the counters of all processors.
+    //
+
+    for (Index = 0; Index < CallbackCtx->KeyFilterProcessorCount; Index++) {
+        for (Counter = 0; Counter < KeyFilterCounterCount; Counter++) {
+            Counters[Counter] += CallbackCtx->KeyFilterCounters[Index].Counters[Counter];
+        }
+    }
+
+    InfoPrint("\tCallbacks: %I64d, decisions from object context: %I64d, "
+              "names resolved: %I64d, blocked: %I64d",
+              Counters[KeyFilterCallbacks],
+              Counters[KeyFilterContextHits],
+              Counters[KeyFilterNamesResolved],
+              Counters[KeyFilterBlocked]);
+
+    //
+    // Each of the three key objects should have had its name resolved
+    // once, no matter how many operations were done on it.
+    //
+
+    if (Counters[KeyFilterNamesResolved] != 3) {
+        ErrorPrint("Names resolved expected 3, instead it was %I64d",
+                   Counters[KeyFilterNamesResolved]);
+        Success = FALSE;
+    }
+
+    if (Counters[KeyFilterBlocked] != KEY_FILTER_SAMPLE_OPERATIONS) {
+        ErrorPrint("Blocked operations expected %d, instead it was %I64d",
+                   KEY_FILTER_SAMPLE_OPERATIONS,
+                   Counters[KeyFilterBlocked]);
+        Success = FALSE;
+    }
+
+    if (CallbackCtx->ContextCleanupCount != 3) {
+        ErrorPrint("Context cleanups expected 3, instead it was %d",
+                   CallbackCtx->ContextCleanupCount);
+        Success = FALSE;
+    }
+
+  Exit:
+
+    //
+    // Clean up
+    //
+
+    if (Key != NULL) {
+        ZwDeleteKey(Key);
+        ZwClose(Key);
+    }
+
+    if (NotModifiedKey != NULL) {
+        ZwDeleteKey(NotModifiedKey);
+        ZwClose(NotModifiedKey);
+    }
+
+    if (CallbackCtx != NULL) {
+        if (CallbackCtx->KeyFilterCounters != NULL) {
+            ExFreePoolWithTag(CallbackCtx->KeyFilterCounters, REGFLTR_CONTEXT_POOL_TAG);
+        }
+        ExFreePoolWithTag(CallbackCtx, REGFLTR_CONTEXT_POOL_TAG);
+    }
+
+    if (Success) {
+        InfoPrint("Key Object Filter Sample succeeded.");
+    } else {
+        ErrorPrint("Key Object Filter Sample FAILED.");
+    }
+
+    return Success;
+
+}
+
+
+NTSTATUS
+CallbackKeyObjectFilter(
+    _In_ PCALLBACK_CONTEXT CallbackCtx,
+    _In_ REG_NOTIFY_CLASS NotifyClass,
+    _Inout_ PVOID Argument2
+    )
+/*++
+
+Routine Description:
+
+    This helper callback routine blocks set value, delete value and delete
+    key operations on the protected keys. The decision comes from the
+    object context of the key object whenever one is set, so the key name
+    is only resolved the first time the callback sees an object.
+
+Arguments:
+
+    CallbackContext - The value that the driver passed to the Context parameter
+        of CmRegisterCallbackEx when it registers this callback routine.
+
+    NotifyClass - A REG_NOTIFY_CLASS typed value that identifies the type of
+        registry operation that is being performed and whether the callback
+        is being called in the pre or post phase of processing.
+
+    Argument2 - A pointer to a structure that contains information specific
+        to the type of the registry operation. The structure type depends
+        on the REG_NOTIFY_CLASS value of Argument1.
+
+Return Value:
+
+    NTSTATUS
+
+--*/
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    PREG_CALLBACK_CONTEXT_CLEANUP_INFORMATION CleanupInfo;
+    PKEY_FILTER_DECISION Decision = NULL;
+    PREG_DELETE_KEY_INFORMATION PreDeleteKeyInfo;
+    PREG_DELETE_VALUE_KEY_INFORMATION PreDeleteValueInfo;
+    PREG_SET_VALUE_KEY_INFORMATION PreSetValueInfo;
+    PREG_POST_OPERATION_INFORMATION PostInfo;
+
+    KeyFilterCount(CallbackCtx, KeyFilterCallbacks);
+
+    switch(NotifyClass) {
+        case RegNtPostCreateKeyEx:
+        case RegNtPostOpenKeyEx:
+
+            //
+            // Decide on a newly opened key object right away.
+            //
+
+            PostInfo = (PREG_POST_OPERATION_INFORMATION) Argument2;
+            if (NT_SUCCESS(PostInfo->Status) && PostInfo->Object != NULL) {
+                KeyFilterGetDecision(CallbackCtx,
+                                     PostInfo->Object,
+                                     PostInfo->ObjectContext);
+            }
+            break;
+
+        case RegNtPreSetValueKey:
+            PreSetValueInfo = (PREG_SET_VALUE_KEY_INFORMATION) Argument2;
+            Decision = KeyFilterGetDecision(CallbackCtx,
+                                            PreSetValueInfo->Object,
+                                            PreSetValueInfo->ObjectContext);
+            break;
+
+        case RegNtPreDeleteValueKey:
+            PreDeleteValueInfo = (PREG_DELETE_VALUE_KEY_INFORMATION) Argument2;
+            Decision = KeyFilterGetDecision(CallbackCtx,
+                                            PreDeleteValueInfo->Object,
+                                            PreDeleteValueInfo->ObjectContext);
+            break;
+
+        case RegNtPreDeleteKey:
+            PreDeleteKeyInfo = (PREG_DELETE_KEY_INFORMATION) Argument2;
+            Decision = KeyFilterGetDecision(CallbackCtx,
+                                            PreDeleteKeyInfo->Object,
+                                            PreDeleteKeyInfo->ObjectContext);
+            break;
+
+        case RegNtCallbackObjectContextCleanup:
+
+            //
+            // The object contexts point at globals so there is nothing to
+            // free. Count the cleanups to check them in the sample.
+            //
+
+            CleanupInfo = (PREG_CALLBACK_CONTEXT_CLEANUP_INFORMATION) Argument2;
+            if (CleanupInfo->ObjectContext == KEY_FILTER_ALLOW ||
+                CleanupInfo->ObjectContext == KEY_FILTER_BLOCK) {
+                InterlockedIncrement(&CallbackCtx->ContextCleanupCount);
+            } else {
+                ErrorPrint("ContextCleanup's ObjectContext has unexpected value: 0x%p.",
+                           CleanupInfo->ObjectContext);
+            }
+            break;
+
+        default:
+            //
+            // Do nothing for other notifications
+            //
+            break;
+    }
+
+    if (Decision != NULL && Decision->Block) {
+        KeyFilterCount(CallbackCtx, KeyFilterBlocked);
+        Status = STATUS_ACCESS_DENIED;
+    }
+
+    return Status;
+}
@@ -97,9 +97,16 @@ Return Value:
         return STATUS_SUCCESS;
     }
 
-    InfoPrint("\tCallback: Altitude-%S, NotifyClass-%S.",
-               CallbackCtx->AltitudeBuffer,
-               GetNotifyClassString(NotifyClass));
+    //
+    // The capture log sample logs a very large number of operations, so
+    // don't print each of them.
+    //
+
+    if (CallbackCtx->CallbackMode != CALLBACK_MODE_CAPTURE_LOG) {
+        InfoPrint("\tCallback: Altitude-%S, NotifyClass-%S.",
+                   CallbackCtx->AltitudeBuffer,
+                   GetNotifyClassString(NotifyClass));
+    }
 
     //
     // Invoke a helper method depending on the value of CallbackMode in 
@@ -160,6 +167,12 @@ Return Value:
         case CALLBACK_MODE_VERSION_CREATE_OPEN_V1:
             Status = CallbackCreateOpenV1(CallbackCtx, NotifyClass, Argument2);
             break;
+        case CALLBACK_MODE_KEY_OBJECT_FILTER:
+            Status = CallbackKeyObjectFilter(CallbackCtx, NotifyClass, Argument2);
+            break;
+        case CALLBACK_MODE_CAPTURE_LOG:
+            Status = CallbackCaptureLog(CallbackCtx, NotifyClass, Argument2);
+            break;
         default: 
             ErrorPrint("Unknown Callback Mode: %d", CallbackCtx->CallbackMode);
             Status = STATUS_INVALID_PARAMETER;
@@ -389,6 +402,9 @@ Return Value:
     Output->SampleResults[KERNELMODE_SAMPLE_VERSION_CREATE_OPEN_V1] =
         CreateOpenV1Sample();
 
+    Output->SampleResults[KERNELMODE_SAMPLE_KEY_OBJECT_FILTER] =
+        KeyObjectFilterSample();
+
     Irp->IoStatus.Information = sizeof(DO_KERNELMODE_SAMPLES_OUTPUT);
 
   Exit:
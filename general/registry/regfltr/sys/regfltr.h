@@ -36,6 +36,7 @@ Environment:
 
 #define REGFLTR_CONTEXT_POOL_TAG          '0tfR'
 #define REGFLTR_CAPTURE_POOL_TAG          '1tfR'
+#define REGFLTR_CAPTURE_LOG_POOL_TAG      '2tfR'
 
 
 //
@@ -133,6 +134,53 @@ typedef struct _RMCALLBACK_CONTEXT {
 } RMCALLBACK_CONTEXT, *PRMCALLBACK_CONTEXT;
 
 
+//
+// Counters of the key object filter sample. Each processor has its own
+// copy, padded to a cache line, so the callbacks of different processors
+// never write the same line.
+//
+
+typedef enum _KEY_FILTER_COUNTER {
+    KeyFilterCallbacks = 0,
+    KeyFilterContextHits,
+    KeyFilterNamesResolved,
+    KeyFilterBlocked,
+    KeyFilterCounterCount
+} KEY_FILTER_COUNTER;
+
+typedef struct DECLSPEC_CACHEALIGN _KEY_FILTER_COUNTERS {
+    LONG64 Counters[KeyFilterCounterCount];
+} KEY_FILTER_COUNTERS, *PKEY_FILTER_COUNTERS;
+
+
+//
+// Kernel side of a capture log. The driver keeps the ring and arena heads
+// here rather than in the shared section, so values the consumer writes
+// into the section can never make the driver write outside of it.
+//
+
+typedef struct _CAPTURE_LOG {
+
+    //
+    // The section and its view in system space
+    //
+    HANDLE Section;
+    PVOID SectionObject;
+    PCAPTURE_LOG_HEADER Header;
+    PCAPTURE_LOG_RECORD Records;
+    PUCHAR Arena;
+
+    //
+    // Guards the reservation of records and arena bytes. The copies are
+    // done outside of the lock.
+    //
+    FAST_MUTEX Lock;
+    ULONG64 RecordHead;
+    ULONG64 ArenaHead;
+
+} CAPTURE_LOG, *PCAPTURE_LOG;
+
+
 //
 // The context data structure for the registry callback. It will be passed 
 // to the callback function every time it is called. 
@@ -206,6 +254,19 @@ typedef struct _CALLBACK_CONTEXT {
     // Number of post-notifications received
     //
     LONG PostNotificationCount;
+
+    //
+    // Per-processor counters, one entry per processor. Only used in the
+    // key object filter sample.
+    //
+    PKEY_FILTER_COUNTERS KeyFilterCounters;
+    ULONG KeyFilterProcessorCount;
+
+    //
+    // The capture log the callback appends to. Only used in the capture
+    // log sample.
+    //
+    PCAPTURE_LOG CaptureLog;
     
 } CALLBACK_CONTEXT, *PCALLBACK_CONTEXT;
 
@@ -365,6 +426,23 @@ CallbackCreateOpenV1(
     _Inout_ PVOID Argument2
     );
 
+BOOLEAN
+KeyObjectFilterSample();
+
+NTSTATUS
+CallbackKeyObjectFilter(
+    _In_ PCALLBACK_CONTEXT CallbackCtx,
+    _In_ REG_NOTIFY_CLASS NotifyClass,
+    _Inout_ PVOID Argument2
+    );
+
+NTSTATUS
+CallbackCaptureLog(
+    _In_ PCALLBACK_CONTEXT CallbackCtx,
+    _In_ REG_NOTIFY_CLASS NotifyClass,
+    _Inout_ PVOID Argument2
+    );
+
 //
 // Driver dispatch functions
 //
@@ -393,6 +471,12 @@ GetCallbackVersion(
     _In_ PIRP Irp
     );
 
+NTSTATUS
+MapCaptureLog(
+    _In_ PDEVICE_OBJECT DeviceObject,
+    _In_ PIRP Irp
+    );
+
 //
 // Transaction related routines
 //
@@ -448,6 +532,11 @@ FreeCapturedUnicodeString(
     _In_ ULONG PoolTag
     );
 
+VOID
+DeleteCaptureLog(
+    _In_ PCAPTURE_LOG CaptureLog
+    );
+
 
 //
 // Utility methods
@@ -298,6 +298,9 @@ Return Value:
 {
 
     if (CallbackCtx != NULL) {
+        if (CallbackCtx->CaptureLog != NULL) {
+            DeleteCaptureLog(CallbackCtx->CaptureLog);
+        }
         ExFreePoolWithTag(CallbackCtx, REGFLTR_CONTEXT_POOL_TAG);
     }
 
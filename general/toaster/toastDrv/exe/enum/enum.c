@@ -54,8 +54,10 @@ OpenBusInterface(
     );
 
 #define USAGE  \
-"Usage: Enum [-p SerialNo] Plugs in a device. SerialNo must be greater than zero.\n\
-             [-u SerialNo or 0] Unplugs device(s) - specify 0 to unplug all \
+"Usage: Enum [-p SerialNo [Count]] Plugs in a device. SerialNo must be greater than zero.\n\
+                                Count plugs in that many devices with consecutive \
+                                serial numbers in one request.\n\
+             [-u SerialNo or 0 [Count]] Unplugs device(s) - specify 0 to unplug all \
                                 the devices enumerated so far.\n\
              [-e SerialNo or 0] Ejects device(s) - specify 0 to eject all \
                                 the devices enumerated so far.\n"
@@ -64,6 +66,7 @@ OpenBusInterface(
 
 BOOLEAN     bPlugIn, bUnplug, bEject;
 ULONG       SerialNo;
+ULONG       Count = 1;
 
 INT __cdecl
 main(
@@ -102,9 +105,16 @@ main(
     else
         goto usage;
 
+    if(argc > 3 && (bPlugIn || bUnplug)) {
+        Count = (ULONG)atol(argv[3]);
+    }
+
     if(bPlugIn && 0 == SerialNo)
         goto usage;
 
+    if(0 == Count || (Count > 1 && 0 == SerialNo))
+        goto usage;
+
     if (GetDevicePath(&GUID_DEVINTERFACE_BUSENUM_TOASTER,
                 devicePath,
                 sizeof(devicePath) / sizeof(devicePath[0]))) {
@@ -126,7 +136,9 @@ OpenBusInterface (
     ULONG                               bytes;
     BUSENUM_UNPLUG_HARDWARE             unplug;
     BUSENUM_EJECT_HARDWARE              eject;
+    BUSENUM_UNPLUG_HARDWARE_BATCH       unplugBatch;
     PBUSENUM_PLUGIN_HARDWARE            hardware;
+    PBUSENUM_PLUGIN_HARDWARE_BATCH      hardwareBatch;
     BOOLEAN                             bSuccess = FALSE;
 
     printf("Opening %ws\n", DevicePath);
@@ -149,7 +161,40 @@ OpenBusInterface (
     // Enumerate Devices
     //
 
-    if(bPlugIn) {
+    if(bPlugIn && Count > 1) {
+
+        printf("SerialNo. of the devices to be enumerated: %d to %d\n",
+               SerialNo, SerialNo + Count - 1);
+
+        hardwareBatch = malloc (bytes = (sizeof (BUSENUM_PLUGIN_HARDWARE_BATCH) +
+                                                   BUS_HARDWARE_IDS_LENGTH));
+
+        if(hardwareBatch) {
+            hardwareBatch->Size = sizeof (BUSENUM_PLUGIN_HARDWARE_BATCH);
+            hardwareBatch->FirstSerialNo = SerialNo;
+            hardwareBatch->Count = Count;
+        } else {
+            printf("Couldn't allocate %d bytes for busenum plugin hardware structure.\n", bytes);
+            goto End;
+        }
+
+        memcpy (hardwareBatch->HardwareIDs,
+                BUS_HARDWARE_IDS,
+                BUS_HARDWARE_IDS_LENGTH);
+
+        if (!DeviceIoControl (file,
+                              IOCTL_BUSENUM_PLUGIN_HARDWARE_BATCH,
+                              hardwareBatch, bytes,
+                              NULL, 0,
+                              &bytes, NULL)) {
+              free (hardwareBatch);
+              printf("PlugIn failed:0x%x\n", GetLastError());
+              goto End;
+        }
+
+        free (hardwareBatch);
+    }
+    else if(bPlugIn) {
 
         printf("SerialNo. of the device to be enumerated: %d\n", SerialNo);
 
@@ -189,7 +234,23 @@ OpenBusInterface (
     // ioctls removes all the devices that are enumerated so far.
     //
 
-    if(bUnplug) {
+    if(bUnplug && Count > 1) {
+        printf("Unplugging device(s)....\n");
+
+        unplugBatch.Size = bytes = sizeof (unplugBatch);
+        unplugBatch.FirstSerialNo = SerialNo;
+        unplugBatch.Count = Count;
+        unplugBatch.Reserved = 0;
+        if (!DeviceIoControl (file,
+                              IOCTL_BUSENUM_UNPLUG_HARDWARE_BATCH,
+                              &unplugBatch, bytes,
+                              NULL, 0,
+                              &bytes, NULL)) {
+            printf("Unplug failed: 0x%x\n", GetLastError());
+            goto End;
+        }
+    }
+    else if(bUnplug) {
         printf("Unplugging device(s)....\n");
 
         unplug.Size = bytes = sizeof (unplug);
@@ -23,8 +23,11 @@ Environment:
 #pragma alloc_text (INIT, DriverEntry)
 #pragma alloc_text (PAGE, Bus_EvtDeviceAdd)
 #pragma alloc_text (PAGE, Bus_EvtIoDeviceControl)
+#pragma alloc_text (PAGE, Bus_EvtDeviceQueryDeviceRelations)
 #pragma alloc_text (PAGE, Bus_PlugInDevice)
+#pragma alloc_text (PAGE, Bus_PlugInDevices)
 #pragma alloc_text (PAGE, Bus_UnPlugDevice)
+#pragma alloc_text (PAGE, Bus_UnPlugDevices)
 #pragma alloc_text (PAGE, Bus_EjectDevice)
 #endif
 
@@ -120,6 +123,7 @@ Return Value:
     PNP_BUS_INFORMATION        busInfo;
     //PFDO_DEVICE_DATA           deviceData;
     WDFQUEUE                   queue;
+    UCHAR                      minorFunction;
 
     UNREFERENCED_PARAMETER(Driver);
 
@@ -193,6 +197,24 @@ Return Value:
                                          &config,
                                          WDF_NO_OBJECT_ATTRIBUTES);
 
+    //
+    // Look at IRP_MN_QUERY_DEVICE_RELATIONS before the framework handles it,
+    // to measure how long reporting the children takes.
+    //
+    minorFunction = IRP_MN_QUERY_DEVICE_RELATIONS;
+
+    status = WdfDeviceInitAssignWdmIrpPreprocessCallback(
+                                DeviceInit,
+                                Bus_EvtDeviceQueryDeviceRelations,
+                                IRP_MJ_PNP,
+                                &minorFunction,
+                                1);
+
+    if (!NT_SUCCESS(status)) {
+        KdPrint(("WdfDeviceInitAssignWdmIrpPreprocessCallback failed status 0x%x\n", status));
+        return status;
+    }
+
     //
     // Initialize attributes structure to specify size and accessor function
     // for storing device context.
@@ -210,6 +232,8 @@ Return Value:
         return status;
     }
 
+    Bus_InitializeSerialNoIndex(device);
+
     //
     // Configure a default queue so that requests that are not
     // configure-fowarded using WdfDeviceConfigureRequestDispatching to goto
@@ -339,6 +363,8 @@ Return Value:
     PBUSENUM_PLUGIN_HARDWARE plugIn = NULL;
     PBUSENUM_UNPLUG_HARDWARE unPlug = NULL;
     PBUSENUM_EJECT_HARDWARE  eject  = NULL;
+    PBUSENUM_PLUGIN_HARDWARE_BATCH plugInBatch = NULL;
+    PBUSENUM_UNPLUG_HARDWARE_BATCH unPlugBatch = NULL;
 
 
     UNREFERENCED_PARAMETER(OutputBufferLength);
@@ -423,6 +449,67 @@ Return Value:
 
         break;
 
+    case IOCTL_BUSENUM_PLUGIN_HARDWARE_BATCH:
+
+        status = WdfRequestRetrieveInputBuffer (Request,
+                                    sizeof (BUSENUM_PLUGIN_HARDWARE_BATCH) +
+                                    (sizeof(UNICODE_NULL) * 2), // 2 for double NULL termination (MULTI_SZ)
+                                    &plugInBatch, &length);
+        if( !NT_SUCCESS(status) ) {
+            KdPrint(("WdfRequestRetrieveInputBuffer failed 0x%x\n", status));
+            break;
+        }
+
+        ASSERT(length == InputBufferLength);
+
+        status = STATUS_INVALID_PARAMETER;
+
+        if (sizeof (BUSENUM_PLUGIN_HARDWARE_BATCH) == plugInBatch->Size)
+        {
+
+            length = (InputBufferLength - sizeof (BUSENUM_PLUGIN_HARDWARE_BATCH))/sizeof(WCHAR);
+            //
+            // Make sure the IDs is two NULL terminated.
+            //
+            if ((UNICODE_NULL != plugInBatch->HardwareIDs[length - 1]) ||
+                (UNICODE_NULL != plugInBatch->HardwareIDs[length - 2])) {
+
+                break;
+            }
+
+            status = Bus_PlugInDevices( hDevice,
+                                        plugInBatch->HardwareIDs,
+                                        length,
+                                        plugInBatch->FirstSerialNo,
+                                        plugInBatch->Count );
+        }
+
+        break;
+
+    case IOCTL_BUSENUM_UNPLUG_HARDWARE_BATCH:
+
+        status = WdfRequestRetrieveInputBuffer( Request,
+                                                sizeof(BUSENUM_UNPLUG_HARDWARE_BATCH),
+                                                &unPlugBatch,
+                                                &length );
+        if( !NT_SUCCESS(status) ) {
+            KdPrint(("WdfRequestRetrieveInputBuffer failed 0x%x\n", status));
+            break;
+        }
+
+        status = STATUS_INVALID_PARAMETER;
+
+        if (unPlugBatch->Size == InputBufferLength)
+        {
+
+            status = Bus_UnPlugDevices(hDevice,
+                                       unPlugBatch->FirstSerialNo,
+                                       unPlugBatch->Count );
+
+        }
+
+        break;
+
     default:
         break; // default status is STATUS_INVALID_PARAMETER
     }
@@ -430,6 +517,75 @@ Return Value:
     WdfRequestCompleteWithInformation(Request, status, length);
 }
 
+NTSTATUS
+Bus_EvtDeviceQueryDeviceRelations(
+    IN WDFDEVICE    Device,
+    IN PIRP         Irp
+    )
+/*++
+Routine Description:
+
+    Measures how long the framework takes to process a query for the bus
+    relations, which is where new children get their PDOs and reported
+    children are walked, and keeps the last and longest time in the device
+    context. All other relation types are passed on untouched.
+
+Arguments:
+
+    Device - Handle to the bus device
+
+    Irp - The IRP_MN_QUERY_DEVICE_RELATIONS request
+
+Return Value:
+
+    NTSTATUS returned by the framework
+
+--*/
+{
+    PIO_STACK_LOCATION  stack;
+    PFDO_DEVICE_DATA    deviceData;
+    LARGE_INTEGER       frequency;
+    LARGE_INTEGER       start;
+    LARGE_INTEGER       end;
+    ULONGLONG           elapsed;
+    NTSTATUS            status;
+
+    PAGED_CODE ();
+
+    stack = IoGetCurrentIrpStackLocation(Irp);
+
+    if (stack->Parameters.QueryDeviceRelations.Type != BusRelations) {
+        return WdfDeviceWdmDispatchPreprocessedIrp(Device, Irp);
+    }
+
+    start = KeQueryPerformanceCounter(&frequency);
+
+    //
+    // The IRP may be completed by the time this returns, so it must not be
+    // touched afterwards.
+    //
+    status = WdfDeviceWdmDispatchPreprocessedIrp(Device, Irp);
+
+    end = KeQueryPerformanceCounter(NULL);
+    elapsed = ((ULONGLONG)(end.QuadPart - start.QuadPart) * 1000000) /
+              (ULONGLONG)frequency.QuadPart;
+
+    deviceData = FdoGetData(Device);
+    deviceData->QdrCount++;
+    deviceData->QdrLastTime = elapsed;
+    deviceData->QdrMaxTime = max(deviceData->QdrMaxTime, elapsed);
+
+    KdPrint(("Bus_EvtDeviceQueryDeviceRelations: %d children reported in %I64u us "
+             "(max %I64u us, %d queries), status 0x%x\n",
+             deviceData->ChildCount,
+             elapsed,
+             deviceData->QdrMaxTime,
+             deviceData->QdrCount,
+             status));
+
+    return status;
+}
+
 NTSTATUS
 Bus_PlugInDevice(
     _In_ WDFDEVICE       Device,
@@ -456,6 +612,15 @@ Routine Description:
 
     PAGED_CODE ();
 
+    //
+    // A serial number stays in use until the child that had it is removed
+    // by PnP, not just reported missing, since both children would have the
+    // same instance ID.
+    //
+    if (Bus_IsSerialNoInUse(Device, SerialNo)) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
     //
     // Initialize the description with the information about the newly
     // plugged in device.
@@ -468,6 +633,7 @@ Routine Description:
     description.SerialNo = SerialNo;
     description.CchHardwareIds = CchHardwareIds;
     description.HardwareIds = HardwareIds;
+    description.Indexed = FALSE;
 
     //
     // Call the framework to add this child to the childlist. This call
@@ -495,6 +661,81 @@ Routine Description:
     return status;
 }
 
+NTSTATUS
+Bus_PlugInDevices(
+    _In_ WDFDEVICE       Device,
+    _In_ PWCHAR          HardwareIds,
+    _In_ size_t          CchHardwareIds,
+    _In_ ULONG           FirstSerialNo,
+    _In_ ULONG           Count
+    )
+
+/*++
+
+Routine Description:
+
+    The user application has told us that a batch of devices with consecutive
+    serial numbers has arrived.
+
+    The devices are added inside a scan, so the framework invalidates the
+    device relations once for the whole batch instead of once per device.
+
+Returns:
+
+    STATUS_SUCCESS if all the devices were added
+    STATUS_INVALID_PARAMETER if the range is invalid or one of its serial
+    numbers is in use, in which case no device is added
+
+--*/
+
+{
+    NTSTATUS         status = STATUS_SUCCESS;
+    WDFCHILDLIST     list;
+    ULONG            i;
+
+    PAGED_CODE ();
+
+    if (0 == FirstSerialNo || 0 == Count || Count > MAX_BATCH_TOASTERS ||
+        FirstSerialNo + (Count - 1) < FirstSerialNo) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    //
+    // Check the whole batch first so that a conflict does not leave it half
+    // plugged in. A concurrent request can still take a serial number after
+    // this check, in which case the batch stops there.
+    //
+    for (i = 0; i < Count; i++) {
+        if (Bus_IsSerialNoInUse(Device, FirstSerialNo + i)) {
+            return STATUS_INVALID_PARAMETER;
+        }
+    }
+
+    list = WdfFdoGetDefaultChildList(Device);
+
+    //
+    // Starting a scan marks every child as potentially missing, so mark the
+    // existing ones present again before adding the batch.
+    //
+    WdfChildListBeginScan(list);
+    WdfChildListUpdateAllChildDescriptionsAsPresent(list);
+
+    for (i = 0; i < Count; i++) {
+        status = Bus_PlugInDevice(Device,
+                                  HardwareIds,
+                                  CchHardwareIds,
+                                  FirstSerialNo + i);
+        if (!NT_SUCCESS(status)) {
+            break;
+        }
+    }
+
+    WdfChildListEndScan(list);
+
+    return status;
+}
+
 NTSTATUS
 Bus_UnPlugDevice(
     WDFDEVICE   Device,
@@ -552,6 +793,12 @@ Returns:
         WdfChildListEndScan(list);
 
     }
+    else if (!Bus_IsSerialNoInUse(Device, SerialNo)) {
+        //
+        // No child has this serial number, no need to search the list.
+        //
+        status = STATUS_INVALID_PARAMETER;
+    }
     else {
         PDO_IDENTIFICATION_DESCRIPTION description;
 
@@ -583,6 +830,79 @@ Returns:
     return status;
 }
 
+NTSTATUS
+Bus_UnPlugDevices(
+    _In_ WDFDEVICE   Device,
+    _In_ ULONG       FirstSerialNo,
+    _In_ ULONG       Count
+    )
+/*++
+
+Routine Description:
+
+    The application has told us a batch of devices with consecutive serial
+    numbers has departed from the bus.
+
+    As for plug in, the batch is reported missing inside a scan so that the
+    device relations are invalidated once.
+
+Returns:
+
+    STATUS_SUCCESS upon successful removal from the list
+    STATUS_INVALID_PARAMETER if the range is invalid or one of its serial
+    numbers is not in use, in which case no device is removed
+
+--*/
+
+{
+    NTSTATUS       status = STATUS_SUCCESS;
+    WDFCHILDLIST   list;
+    ULONG          i;
+
+    PAGED_CODE ();
+
+    if (0 == FirstSerialNo || 0 == Count || Count > MAX_BATCH_TOASTERS ||
+        FirstSerialNo + (Count - 1) < FirstSerialNo) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    for (i = 0; i < Count; i++) {
+        if (!Bus_IsSerialNoInUse(Device, FirstSerialNo + i)) {
+            return STATUS_INVALID_PARAMETER;
+        }
+    }
+
+    list = WdfFdoGetDefaultChildList(Device);
+
+    WdfChildListBeginScan(list);
+    WdfChildListUpdateAllChildDescriptionsAsPresent(list);
+
+    for (i = 0; i < Count; i++) {
+        PDO_IDENTIFICATION_DESCRIPTION description;
+
+        WDF_CHILD_IDENTIFICATION_DESCRIPTION_HEADER_INIT(
+            &description.Header,
+            sizeof(description)
+            );
+
+        description.SerialNo = FirstSerialNo + i;
+
+        status = WdfChildListUpdateChildDescriptionAsMissing(list,
+                                                              &description.Header);
+        if (!NT_SUCCESS(status)) {
+            if (status == STATUS_NO_SUCH_DEVICE) {
+                status = STATUS_INVALID_PARAMETER;
+            }
+            break;
+        }
+    }
+
+    WdfChildListEndScan(list);
+
+    return status;
+}
+
 NTSTATUS
 Bus_EjectDevice(
     WDFDEVICE   Device,
@@ -673,7 +993,7 @@ Returns:
         }
 
     }
-    else {
+    else if (Bus_IsSerialNoInUse(Device, SerialNo)) {
 
         PDO_IDENTIFICATION_DESCRIPTION description;
 
@@ -771,4 +1091,184 @@ Routine Description:
     return status;
 }
 
+VOID
+Bus_InitializeSerialNoIndex(
+    _In_ WDFDEVICE Device
+    )
+/*++
+Routine Description:
+
+    Initializes the empty serial number index of the bus.
+
+--*/
+{
+    PFDO_DEVICE_DATA    deviceData;
+    ULONG               i;
+
+    deviceData = FdoGetData(Device);
+
+    KeInitializeSpinLock(&deviceData->SerialNoLock);
+
+    for (i = 0; i < BUS_SERIALNO_BUCKETS; i++) {
+        InitializeListHead(&deviceData->SerialNoBuckets[i]);
+    }
+
+    deviceData->ChildCount = 0;
+}
+
+static
+PBUS_SERIALNO_ENTRY
+Bus_FindSerialNoLocked(
+    _In_ PFDO_DEVICE_DATA DeviceData,
+    _In_ ULONG            SerialNo
+    )
+/*++
+Routine Description:
+
+    Looks up a serial number in the index. Called with SerialNoLock held.
+
+--*/
+{
+    PLIST_ENTRY         bucket;
+    PLIST_ENTRY         entry;
+    PBUS_SERIALNO_ENTRY serialNoEntry;
+
+    bucket = &DeviceData->SerialNoBuckets[SerialNo & (BUS_SERIALNO_BUCKETS - 1)];
+
+    for (entry = bucket->Flink; entry != bucket; entry = entry->Flink) {
+        serialNoEntry = CONTAINING_RECORD(entry, BUS_SERIALNO_ENTRY, Link);
+        if (serialNoEntry->SerialNo == SerialNo) {
+            return serialNoEntry;
+        }
+    }
+
+    return NULL;
+}
+
+NTSTATUS
+Bus_AddSerialNo(
+    _In_ WDFDEVICE Device,
+    _In_ ULONG     SerialNo
+    )
+/*++
+Routine Description:
+
+    Adds a reference on a serial number in the index, for a description the
+    child list now holds. Called from the description duplicate callback,
+    with the child list lock held.
+
+--*/
+{
+    PFDO_DEVICE_DATA    deviceData;
+    PBUS_SERIALNO_ENTRY serialNoEntry;
+    PBUS_SERIALNO_ENTRY newEntry;
+    KIRQL               oldIrql;
+
+    deviceData = FdoGetData(Device);
+
+    //
+    // Allocate before taking the lock; it is freed again if the serial
+    // number is already indexed.
+    //
+    newEntry = (PBUS_SERIALNO_ENTRY) ExAllocatePoolWithTag(
+        NonPagedPool,
+        sizeof(BUS_SERIALNO_ENTRY),
+        BUS_TAG);
+
+    if (newEntry == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    KeAcquireSpinLock(&deviceData->SerialNoLock, &oldIrql);
 
+    serialNoEntry = Bus_FindSerialNoLocked(deviceData, SerialNo);
+    if (serialNoEntry != NULL) {
+        serialNoEntry->References++;
+    }
+    else {
+        newEntry->SerialNo = SerialNo;
+        newEntry->References = 1;
+        InsertTailList(&deviceData->SerialNoBuckets[SerialNo & (BUS_SERIALNO_BUCKETS - 1)],
+                       &newEntry->Link);
+        deviceData->ChildCount++;
+        newEntry = NULL;
+    }
+
+    KeReleaseSpinLock(&deviceData->SerialNoLock, oldIrql);
+
+    if (newEntry != NULL) {
+        ExFreePool(newEntry);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+Bus_RemoveSerialNo(
+    _In_ WDFDEVICE Device,
+    _In_ ULONG     SerialNo
+    )
+/*++
+Routine Description:
+
+    Drops the reference Bus_AddSerialNo took, when the child list frees the
+    description. Called from the description cleanup callback.
+
+--*/
+{
+    PFDO_DEVICE_DATA    deviceData;
+    PBUS_SERIALNO_ENTRY serialNoEntry;
+    KIRQL               oldIrql;
+
+    deviceData = FdoGetData(Device);
+
+    KeAcquireSpinLock(&deviceData->SerialNoLock, &oldIrql);
+
+    serialNoEntry = Bus_FindSerialNoLocked(deviceData, SerialNo);
+
+    ASSERT(serialNoEntry != NULL);
+
+    if (serialNoEntry != NULL) {
+        serialNoEntry->References--;
+        if (serialNoEntry->References == 0) {
+            RemoveEntryList(&serialNoEntry->Link);
+            deviceData->ChildCount--;
+        }
+        else {
+            serialNoEntry = NULL;
+        }
+    }
+
+    KeReleaseSpinLock(&deviceData->SerialNoLock, oldIrql);
+
+    if (serialNoEntry != NULL) {
+        ExFreePool(serialNoEntry);
+    }
+}
+
+BOOLEAN
+Bus_IsSerialNoInUse(
+    _In_ WDFDEVICE Device,
+    _In_ ULONG     SerialNo
+    )
+/*++
+Routine Description:
+
+    Tells whether the child list holds a description with this serial number,
+    either for a present child or for one that is reported missing but not
+    yet removed.
+
+--*/
+{
+    PFDO_DEVICE_DATA    deviceData;
+    BOOLEAN             inUse;
+    KIRQL               oldIrql;
+
+    deviceData = FdoGetData(Device);
+
+    KeAcquireSpinLock(&deviceData->SerialNoLock, &oldIrql);
+    inUse = (Bus_FindSerialNoLocked(deviceData, SerialNo) != NULL) ? TRUE : FALSE;
+    KeReleaseSpinLock(&deviceData->SerialNoLock, oldIrql);
+
+    return inUse;
+}
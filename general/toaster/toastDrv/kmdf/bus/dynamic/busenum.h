@@ -38,8 +38,14 @@ extern ULONG BusEnumDebugLevel;
 
 #define DEF_STATICALLY_ENUMERATED_TOASTERS      0
 #define MAX_STATICALLY_ENUMERATED_TOASTERS      10
+#define MAX_BATCH_TOASTERS                      8192
 #define MAX_INSTANCE_ID_LEN 80
 
+//
+// Number of buckets of the serial number index. Must be a power of two.
+//
+#define BUS_SERIALNO_BUCKETS                    1024
+
 #ifndef min
 #define min(_a, _b)     (((_a) < (_b)) ? (_a) : (_b))
 #endif
@@ -91,8 +97,28 @@ typedef struct _PDO_IDENTIFICATION_DESCRIPTION
 
     _Field_size_bytes_(CchHardwareIds) PWCHAR HardwareIds;
 
+    //
+    // TRUE if the serial number of this description was added to the
+    // serial number index of the bus.
+    //
+    BOOLEAN Indexed;
+
 } PDO_IDENTIFICATION_DESCRIPTION, *PPDO_IDENTIFICATION_DESCRIPTION;
 
+//
+// Entry of the serial number index. References counts the descriptions
+// with this serial number held by the child list.
+//
+typedef struct _BUS_SERIALNO_ENTRY
+{
+    LIST_ENTRY Link;
+
+    ULONG SerialNo;
+
+    ULONG References;
+
+} BUS_SERIALNO_ENTRY, *PBUS_SERIALNO_ENTRY;
+
 //
 // This is PDO device-extension.
 //
@@ -114,6 +140,27 @@ typedef struct _FDO_DEVICE_DATA
 {
     TOASTER_BUS_WMI_STD_DATA   StdToasterBusData;
 
+    //
+    // Index of the serial numbers of the descriptions in the child list,
+    // hashed by serial number. It is maintained by the description duplicate
+    // and cleanup callbacks, so that requests for serial numbers that are or
+    // are not in use can be answered without searching the child list.
+    // A KSPIN_LOCK is used because the callbacks run at DISPATCH_LEVEL and
+    // the last cleanups run while the child list is deleted, after the
+    // device's other child objects may be gone.
+    //
+    KSPIN_LOCK                 SerialNoLock;
+    LIST_ENTRY                 SerialNoBuckets[BUS_SERIALNO_BUCKETS];
+    ULONG                      ChildCount;
+
+    //
+    // Processing time of IRP_MN_QUERY_DEVICE_RELATIONS for BusRelations,
+    // in microseconds.
+    //
+    ULONG                      QdrCount;
+    ULONGLONG                  QdrLastTime;
+    ULONGLONG                  QdrMaxTime;
+
 } FDO_DEVICE_DATA, *PFDO_DEVICE_DATA;
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(FDO_DEVICE_DATA, FdoGetData)
@@ -128,6 +175,8 @@ EVT_WDF_DRIVER_DEVICE_ADD Bus_EvtDeviceAdd;
 
 EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL Bus_EvtIoDeviceControl;
 
+EVT_WDFDEVICE_WDM_IRP_PREPROCESS Bus_EvtDeviceQueryDeviceRelations;
+
 EVT_WDF_CHILD_LIST_CREATE_DEVICE Bus_EvtDeviceListCreatePdo;
 EVT_WDF_CHILD_LIST_IDENTIFICATION_DESCRIPTION_COMPARE Bus_EvtChildListIdentificationDescriptionCompare;
 EVT_WDF_CHILD_LIST_IDENTIFICATION_DESCRIPTION_CLEANUP Bus_EvtChildListIdentificationDescriptionCleanup;
@@ -141,12 +190,28 @@ Bus_PlugInDevice(
     _In_ ULONG           SerialNo
     );
 
+NTSTATUS
+Bus_PlugInDevices(
+    _In_ WDFDEVICE       Device,
+    _In_ PWCHAR          HardwareIds,
+    _In_ size_t          CchHardwareIds,
+    _In_ ULONG           FirstSerialNo,
+    _In_ ULONG           Count
+    );
+
 NTSTATUS
 Bus_UnPlugDevice(
     WDFDEVICE   Device,
     ULONG       SerialNo
     );
 
+NTSTATUS
+Bus_UnPlugDevices(
+    _In_ WDFDEVICE   Device,
+    _In_ ULONG       FirstSerialNo,
+    _In_ ULONG       Count
+    );
+
 
 NTSTATUS
 Bus_EjectDevice(
@@ -167,6 +232,33 @@ Bus_DoStaticEnumeration(
     IN WDFDEVICE Device
     );
 
+//
+// Serial number index
+//
+
+VOID
+Bus_InitializeSerialNoIndex(
+    _In_ WDFDEVICE Device
+    );
+
+NTSTATUS
+Bus_AddSerialNo(
+    _In_ WDFDEVICE Device,
+    _In_ ULONG     SerialNo
+    );
+
+VOID
+Bus_RemoveSerialNo(
+    _In_ WDFDEVICE Device,
+    _In_ ULONG     SerialNo
+    );
+
+BOOLEAN
+Bus_IsSerialNoInUse(
+    _In_ WDFDEVICE Device,
+    _In_ ULONG     SerialNo
+    );
+
 
 //
 // Interface functions
@@ -63,8 +63,6 @@ Return Value:
     size_t safeMultResult;
     NTSTATUS status;
 
-    UNREFERENCED_PARAMETER(DeviceList);
-
     src = CONTAINING_RECORD(SourceIdentificationDescription,
                             PDO_IDENTIFICATION_DESCRIPTION,
                             Header);
@@ -74,6 +72,8 @@ Return Value:
 
     dst->SerialNo = src->SerialNo;
     dst->CchHardwareIds = src->CchHardwareIds;
+    dst->HardwareIds = NULL;
+    dst->Indexed = FALSE;
     status = RtlSizeTMult(dst->CchHardwareIds,
                                   sizeof(WCHAR),
                                   &safeMultResult
@@ -95,6 +95,19 @@ Return Value:
                   src->HardwareIds,
                   dst->CchHardwareIds * sizeof(WCHAR));
 
+    //
+    // This copy is the one the child list keeps, so it is the one that
+    // represents the serial number in the index.
+    //
+    status = Bus_AddSerialNo(WdfChildListGetDevice(DeviceList), dst->SerialNo);
+    if (!NT_SUCCESS(status)) {
+        ExFreePool(dst->HardwareIds);
+        dst->HardwareIds = NULL;
+        return status;
+    }
+
+    dst->Indexed = TRUE;
+
     return STATUS_SUCCESS;
 }
 
@@ -171,8 +184,6 @@ Return Value:
     PPDO_IDENTIFICATION_DESCRIPTION pDesc;
 
 
-    UNREFERENCED_PARAMETER(DeviceList);
-
     pDesc = CONTAINING_RECORD(IdentificationDescription,
                               PDO_IDENTIFICATION_DESCRIPTION,
                               Header);
@@ -181,6 +192,11 @@ Return Value:
         ExFreePool(pDesc->HardwareIds);
         pDesc->HardwareIds = NULL;
     }
+
+    if (pDesc->Indexed) {
+        Bus_RemoveSerialNo(WdfChildListGetDevice(DeviceList), pDesc->SerialNo);
+        pDesc->Indexed = FALSE;
+    }
 }
 
 #pragma prefast(pop) // disable:6101
@@ -95,6 +95,8 @@ DEFINE_GUID (TOASTER_NOTIFY_DEVICE_ARRIVAL_EVENT,
 #define IOCTL_BUSENUM_UNPLUG_HARDWARE               BUSENUM_IOCTL (0x1)
 #define IOCTL_BUSENUM_EJECT_HARDWARE                BUSENUM_IOCTL (0x2)
 #define IOCTL_TOASTER_DONT_DISPLAY_IN_UI_DEVICE     BUSENUM_IOCTL (0x3)
+#define IOCTL_BUSENUM_PLUGIN_HARDWARE_BATCH         BUSENUM_IOCTL (0x4)
+#define IOCTL_BUSENUM_UNPLUG_HARDWARE_BATCH         BUSENUM_IOCTL (0x5)
 
 //
 //  Data structure used in PlugIn and UnPlug ioctls
@@ -163,5 +165,59 @@ typedef struct _BUSENUM_EJECT_HARDWARE
 
 } BUSENUM_EJECT_HARDWARE, *PBUSENUM_EJECT_HARDWARE;
 
+//
+//  Data structures used in the batched PlugIn and UnPlug ioctls. A batch
+//  covers the serial numbers FirstSerialNo through FirstSerialNo + Count - 1
+//  and is reported to PnP as a single change of the bus relations.
+//
+
+typedef struct _BUSENUM_PLUGIN_HARDWARE_BATCH
+{
+    //
+    // sizeof (struct _BUSENUM_PLUGIN_HARDWARE_BATCH)
+    //
+    IN ULONG Size;
+
+    //
+    // Serial number of the first device to be enumerated. The batch is
+    // failed if any of its serial numbers is already in use.
+    //
+
+    IN ULONG FirstSerialNo;
+
+    IN ULONG Count;
+
+    //
+    // Hardware IDs of every device in the batch (MULTI_SZ)
+    //
+    #pragma warning(disable:4200)  // nonstandard extension used
+
+    IN  WCHAR   HardwareIDs[];
+
+    #pragma warning(default:4200)
+
+} BUSENUM_PLUGIN_HARDWARE_BATCH, *PBUSENUM_PLUGIN_HARDWARE_BATCH;
+
+typedef struct _BUSENUM_UNPLUG_HARDWARE_BATCH
+{
+    //
+    // sizeof (struct _BUSENUM_UNPLUG_HARDWARE_BATCH)
+    //
+
+    IN ULONG Size;
+
+    //
+    // Serial number of the first device to be plugged out. The batch is
+    // failed if any of its serial numbers is not in use.
+    //
+
+    ULONG   FirstSerialNo;
+
+    ULONG   Count;
+
+    ULONG Reserved;
+
+} BUSENUM_UNPLUG_HARDWARE_BATCH, *PBUSENUM_UNPLUG_HARDWARE_BATCH;
+
 #endif
 
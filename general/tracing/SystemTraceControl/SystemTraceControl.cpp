@@ -28,6 +28,7 @@ Environment:
 #include <stdio.h>
 #include <strsafe.h>
 #include <evntrace.h>
+#include <evntcons.h>
 
 #define MAXIMUM_SESSION_NAME 1024
 
@@ -105,9 +106,818 @@ FreeTraceProperties (
     return;
 }
 
+//
+// Real-time consumer mode.
+//
+// With -realtime the session delivers its buffers to a consumer in this
+// process instead of writing a file. The callback parses the few kernel
+// events it needs directly from their fixed MOF layouts and folds them into
+// histograms preallocated in RealTimeState, so nothing is allocated or
+// formatted per event. A summary of each window is printed from the
+// callback itself, which keeps all the statistics on the consumer thread.
+//
+
+DEFINE_GUID ( /* 3d6fa8d1-fe05-11d0-9dda-00c04fd7ba7c */
+    ThreadGuid,
+    0x3d6fa8d1,
+    0xfe05,
+    0x11d0,
+    0x9d, 0xda, 0x00, 0xc0, 0x4f, 0xd7, 0xba, 0x7c
+  );
+
+DEFINE_GUID ( /* 3d6fa8d4-fe05-11d0-9dda-00c04fd7ba7c */
+    DiskIoGuid,
+    0x3d6fa8d4,
+    0xfe05,
+    0x11d0,
+    0x9d, 0xda, 0x00, 0xc0, 0x4f, 0xd7, 0xba, 0x7c
+  );
+
+DEFINE_GUID ( /* ce1dbfb4-137e-4da6-87b0-3f59aa102cbc */
+    PerfInfoGuid,
+    0xce1dbfb4,
+    0x137e,
+    0x4da6,
+    0x87, 0xb0, 0x3f, 0x59, 0xaa, 0x10, 0x2c, 0xbc
+  );
+
+//
+// Opcodes of the events the consumer aggregates.
+//
+
+#define CSWITCH_OPCODE              36
+#define DISK_READ_OPCODE            10
+#define DISK_WRITE_OPCODE           11
+#define THREADED_DPC_OPCODE         66
+#define ISR_OPCODE                  67
+#define DPC_OPCODE                  68
+#define TIMER_DPC_OPCODE            69
+#define RT_LOST_EVENT_OPCODE        32
+#define RT_LOST_BUFFER_OPCODE       33
+
+#define DEFAULT_REALTIME_SECONDS    60
+#define DEFAULT_SUMMARY_SECONDS     5
+
+//
+// Bucket 0 counts values below 1 us and bucket N values from 2^(N-1) us to
+// 2^N us. The last bucket also takes everything larger.
+//
+
+#define HISTOGRAM_BUCKETS           24
+
+#define MAXIMUM_MODULES             2048
+#define MAXIMUM_MODULE_NAME         32
+#define TOP_MODULES                 10
+
+typedef struct _HISTOGRAM {
+    ULONG64 Count;
+    ULONG64 Total;
+    ULONG64 Maximum;
+    ULONG64 Buckets[HISTOGRAM_BUCKETS];
+} HISTOGRAM, *PHISTOGRAM;
+
+typedef struct _MODULE_TIME {
+    ULONG64 DpcCount;
+    ULONG64 DpcTime;
+    ULONG64 DpcMaximum;
+    ULONG64 IsrCount;
+    ULONG64 IsrTime;
+    ULONG64 IsrMaximum;
+} MODULE_TIME, *PMODULE_TIME;
+
+typedef struct _MODULE_STATISTICS {
+    ULONG64 Base;
+    ULONG64 Size;
+    WCHAR Name[MAXIMUM_MODULE_NAME];
+    MODULE_TIME Window;
+} MODULE_STATISTICS, *PMODULE_STATISTICS;
+
+typedef struct _REALTIME_STATE {
+
+    //
+    // Event time stamps and the times inside the events are raw
+    // QueryPerformanceCounter values.
+    //
+    LONGLONG Frequency;
+    LONGLONG SummaryTicks;
+    LONGLONG WindowStart;
+    LONGLONG LastTimestamp;
+
+    ULONG64 Events;
+    ULONG64 LostEvents;
+    ULONG64 LostBuffers;
+
+    HISTOGRAM DiskRead;
+    HISTOGRAM DiskWrite;
+    HISTOGRAM RunTime;
+    HISTOGRAM Dpc;
+    HISTOGRAM Isr;
+
+    //
+    // Time stamp of the last context switch on each processor.
+    //
+    ULONG ProcessorCount;
+    PLONGLONG LastSwitch;
+
+    //
+    // Kernel modules sorted by base address, for attributing DPC and ISR
+    // routines.
+    //
+    ULONG ModuleCount;
+    MODULE_STATISTICS Modules[MAXIMUM_MODULES];
+    MODULE_STATISTICS UnknownModule;
+
+} REALTIME_STATE, *PREALTIME_STATE;
+
+REALTIME_STATE RealTimeState;
+HANDLE RealTimeStopEvent;
+
+ULONG64
+TicksToMicroseconds (
+    _In_ LONGLONG Ticks
+    )
+{
+    LONGLONG Frequency = RealTimeState.Frequency;
+
+    if (Ticks <= 0 || Frequency == 0) {
+        return 0;
+    }
+
+    return (ULONG64)(Ticks / Frequency) * 1000000 +
+           (ULONG64)(Ticks % Frequency) * 1000000 / Frequency;
+}
+
+VOID
+HistogramAdd (
+    _Inout_ PHISTOGRAM Histogram,
+    _In_ ULONG64 Microseconds
+    )
+{
+    ULONG Bucket = 0;
+    ULONG Index;
+
+    if (Microseconds != 0) {
+        BitScanReverse(&Index,
+                       (Microseconds > MAXULONG) ? MAXULONG : (ULONG)Microseconds);
+
+        Bucket = Index + 1;
+        if (Bucket >= HISTOGRAM_BUCKETS) {
+            Bucket = HISTOGRAM_BUCKETS - 1;
+        }
+    }
+
+    Histogram->Count += 1;
+    Histogram->Total += Microseconds;
+    Histogram->Buckets[Bucket] += 1;
+
+    if (Microseconds > Histogram->Maximum) {
+        Histogram->Maximum = Microseconds;
+    }
+}
+
+ULONG
+EventPointerSize (
+    _In_ PEVENT_RECORD EventRecord
+    )
+{
+    return ((EventRecord->EventHeader.Flags & EVENT_HEADER_FLAG_32_BIT_HEADER) != 0) ? 4 : 8;
+}
+
+ULONG64
+ReadEventPointer (
+    _In_ PEVENT_RECORD EventRecord,
+    _In_ ULONG Offset
+    )
+{
+    PUCHAR Data = (PUCHAR)EventRecord->UserData + Offset;
+
+    if (EventPointerSize(EventRecord) == 4) {
+        return *(UNALIGNED ULONG *)Data;
+    }
+
+    return *(UNALIGNED ULONG64 *)Data;
+}
+
+PMODULE_STATISTICS
+FindModule (
+    _In_ ULONG64 Address
+    )
+{
+    LONG High = (LONG)RealTimeState.ModuleCount - 1;
+    LONG Low = 0;
+    LONG Middle;
+    PMODULE_STATISTICS Module;
+
+    while (Low <= High) {
+        Middle = (Low + High) / 2;
+        Module = &RealTimeState.Modules[Middle];
+
+        if (Address < Module->Base) {
+            High = Middle - 1;
+
+        } else if (Address >= Module->Base + Module->Size) {
+            Low = Middle + 1;
+
+        } else {
+            return Module;
+        }
+    }
+
+    return &RealTimeState.UnknownModule;
+}
+
+VOID
+AddModule (
+    _In_ ULONG64 Base,
+    _In_ ULONG64 Size,
+    _In_reads_(FileNameLength) PCWSTR FileName,
+    _In_ ULONG FileNameLength
+    )
+{
+    ULONG Index;
+    ULONG Length;
+    PMODULE_STATISTICS Module;
+    ULONG NameStart = 0;
+
+    for (Index = 0; Index < RealTimeState.ModuleCount; Index += 1) {
+        if (RealTimeState.Modules[Index].Base >= Base) {
+            break;
+        }
+    }
+
+    //
+    // A module loaded where an unloaded one was replaces it.
+    //
+
+    if (Index == RealTimeState.ModuleCount ||
+        RealTimeState.Modules[Index].Base != Base) {
+
+        if (RealTimeState.ModuleCount == MAXIMUM_MODULES) {
+            return;
+        }
+
+        MoveMemory(&RealTimeState.Modules[Index + 1],
+                   &RealTimeState.Modules[Index],
+                   (RealTimeState.ModuleCount - Index) * sizeof(MODULE_STATISTICS));
+
+        RealTimeState.ModuleCount += 1;
+    }
+
+    Module = &RealTimeState.Modules[Index];
+    ZeroMemory(Module, sizeof(*Module));
+    Module->Base = Base;
+    Module->Size = Size;
+
+    //
+    // Keep the file name only, without the directory.
+    //
+
+    for (Length = 0; Length < FileNameLength && FileName[Length] != L'\0'; Length += 1) {
+        if (FileName[Length] == L'\\') {
+            NameStart = Length + 1;
+        }
+    }
+
+    StringCchCopyN(Module->Name,
+                   MAXIMUM_MODULE_NAME,
+                   FileName + NameStart,
+                   Length - NameStart);
+}
+
+VOID
+OnImageLoad (
+    _In_ PEVENT_RECORD EventRecord
+    )
+{
+    ULONG FileNameOffset;
+    ULONG PointerSize = EventPointerSize(EventRecord);
+    ULONG ProcessId;
+
+    //
+    // Image_Load, version 2 and later: ImageBase, ImageSize, ProcessId,
+    // four ULONGs, DefaultBase, four ULONGs, FileName. Kernel modules are
+    // reported with process ID 0.
+    //
+
+    FileNameOffset = 3 * PointerSize + 32;
+
+    if (EventRecord->EventHeader.EventDescriptor.Version < 2 ||
+        EventRecord->UserDataLength < FileNameOffset) {
+        return;
+    }
+
+    ProcessId = *(UNALIGNED ULONG *)((PUCHAR)EventRecord->UserData + 2 * PointerSize);
+    if (ProcessId != 0) {
+        return;
+    }
+
+    AddModule(ReadEventPointer(EventRecord, 0),
+              ReadEventPointer(EventRecord, PointerSize),
+              (PCWSTR)((PUCHAR)EventRecord->UserData + FileNameOffset),
+              (EventRecord->UserDataLength - FileNameOffset) / sizeof(WCHAR));
+}
+
+VOID
+OnDiskIo (
+    _In_ PEVENT_RECORD EventRecord
+    )
+{
+    ULONG PointerSize = EventPointerSize(EventRecord);
+    ULONG ResponseTimeOffset;
+    ULONG64 Microseconds;
+
+    //
+    // DiskIo_TypeGroup1: DiskNumber, IrpFlags, TransferSize, Reserved,
+    // ByteOffset, FileObject, Irp, HighResResponseTime, ...
+    //
+
+    ResponseTimeOffset = 24 + 2 * PointerSize;
+
+    if (EventRecord->UserDataLength < ResponseTimeOffset + sizeof(ULONG64)) {
+        return;
+    }
+
+    Microseconds = TicksToMicroseconds(*(UNALIGNED LONGLONG *)((PUCHAR)EventRecord->UserData +
+                                                               ResponseTimeOffset));
+
+    if (EventRecord->EventHeader.EventDescriptor.Opcode == DISK_READ_OPCODE) {
+        HistogramAdd(&RealTimeState.DiskRead, Microseconds);
+
+    } else {
+        HistogramAdd(&RealTimeState.DiskWrite, Microseconds);
+    }
+}
+
+VOID
+OnContextSwitch (
+    _In_ PEVENT_RECORD EventRecord
+    )
+{
+    ULONG Processor = GetEventProcessorIndex(EventRecord);
+    LONGLONG Timestamp = EventRecord->EventHeader.TimeStamp.QuadPart;
+
+    if (Processor >= RealTimeState.ProcessorCount) {
+        return;
+    }
+
+    //
+    // The time since the previous switch on this processor is how long the
+    // thread being switched out ran.
+    //
+
+    if (RealTimeState.LastSwitch[Processor] != 0) {
+        HistogramAdd(&RealTimeState.RunTime,
+                     TicksToMicroseconds(Timestamp - RealTimeState.LastSwitch[Processor]));
+    }
+
+    RealTimeState.LastSwitch[Processor] = Timestamp;
+}
+
+VOID
+OnDpcOrIsr (
+    _In_ PEVENT_RECORD EventRecord
+    )
+{
+    LONGLONG InitialTime;
+    ULONG64 Microseconds;
+    PMODULE_STATISTICS Module;
+
+    //
+    // DPC and ISR events start with InitialTime and Routine. The event is
+    // logged when the routine returns, so its time stamp ends the interval.
+    //
+
+    if (EventRecord->UserDataLength < sizeof(ULONG64) + EventPointerSize(EventRecord)) {
+        return;
+    }
+
+    InitialTime = *(UNALIGNED LONGLONG *)EventRecord->UserData;
+    Microseconds = TicksToMicroseconds(EventRecord->EventHeader.TimeStamp.QuadPart - InitialTime);
+    Module = FindModule(ReadEventPointer(EventRecord, sizeof(ULONG64)));
+
+    if (EventRecord->EventHeader.EventDescriptor.Opcode == ISR_OPCODE) {
+        HistogramAdd(&RealTimeState.Isr, Microseconds);
+        Module->Window.IsrCount += 1;
+        Module->Window.IsrTime += Microseconds;
+        if (Microseconds > Module->Window.IsrMaximum) {
+            Module->Window.IsrMaximum = Microseconds;
+        }
+
+    } else {
+        HistogramAdd(&RealTimeState.Dpc, Microseconds);
+        Module->Window.DpcCount += 1;
+        Module->Window.DpcTime += Microseconds;
+        if (Microseconds > Module->Window.DpcMaximum) {
+            Module->Window.DpcMaximum = Microseconds;
+        }
+    }
+}
+
+VOID
+PrintHistogram (
+    _In_ PCWSTR Name,
+    _In_ PHISTOGRAM Histogram,
+    _In_ double Seconds
+    )
+{
+    ULONG Bucket;
+
+    wprintf(L"%-20s %10I64u (%9.0f/s)",
+            Name,
+            Histogram->Count,
+            (double)Histogram->Count / Seconds);
+
+    if (Histogram->Count == 0) {
+        wprintf(L"\n");
+        return;
+    }
+
+    wprintf(L"  avg %9.1f us  max %9I64u us\n",
+            (double)Histogram->Total / (double)Histogram->Count,
+            Histogram->Maximum);
+
+    //
+    // One entry per non-empty bucket, labeled with its lower bound in us.
+    //
+
+    wprintf(L"   ");
+    for (Bucket = 0; Bucket < HISTOGRAM_BUCKETS; Bucket += 1) {
+        if (Histogram->Buckets[Bucket] != 0) {
+            wprintf(L" [%u]%I64u",
+                    (Bucket == 0) ? 0 : (1UL << (Bucket - 1)),
+                    Histogram->Buckets[Bucket]);
+        }
+    }
+
+    wprintf(L"\n");
+}
+
+VOID
+PrintTopModules (
+    VOID
+    )
+{
+    ULONG Count = 0;
+    ULONG Index;
+    PMODULE_STATISTICS Module;
+    ULONG Position;
+    PMODULE_STATISTICS Top[TOP_MODULES];
+
+    //
+    // Keep the modules with the most DPC and ISR time, in decreasing order.
+    //
+
+    for (Index = 0; Index <= RealTimeState.ModuleCount; Index += 1) {
+        if (Index == RealTimeState.ModuleCount) {
+            Module = &RealTimeState.UnknownModule;
+        } else {
+            Module = &RealTimeState.Modules[Index];
+        }
+
+        if (Module->Window.DpcCount + Module->Window.IsrCount == 0) {
+            continue;
+        }
+
+        for (Position = Count; Position > 0; Position -= 1) {
+            if (Top[Position - 1]->Window.DpcTime + Top[Position - 1]->Window.IsrTime >=
+                Module->Window.DpcTime + Module->Window.IsrTime) {
+                break;
+            }
+
+            if (Position < TOP_MODULES) {
+                Top[Position] = Top[Position - 1];
+            }
+        }
+
+        if (Position < TOP_MODULES) {
+            Top[Position] = Module;
+            if (Count < TOP_MODULES) {
+                Count += 1;
+            }
+        }
+    }
+
+    if (Count == 0) {
+        return;
+    }
+
+    wprintf(L"%-24s %10s %10s %8s %10s %10s %8s\n",
+            L"Module", L"DPCs", L"DPC us", L"max", L"ISRs", L"ISR us", L"max");
+
+    for (Index = 0; Index < Count; Index += 1) {
+        Module = Top[Index];
+        wprintf(L"%-24s %10I64u %10I64u %8I64u %10I64u %10I64u %8I64u\n",
+                Module->Name,
+                Module->Window.DpcCount,
+                Module->Window.DpcTime,
+                Module->Window.DpcMaximum,
+                Module->Window.IsrCount,
+                Module->Window.IsrTime,
+                Module->Window.IsrMaximum);
+    }
+}
+
+VOID
+PrintSummary (
+    _In_ LONGLONG Timestamp
+    )
+{
+    ULONG Index;
+    double Seconds;
+
+    Seconds = (double)(Timestamp - RealTimeState.WindowStart) /
+              (double)RealTimeState.Frequency;
+
+    if (Seconds <= 0) {
+        return;
+    }
+
+    wprintf(L"\n--- %.1f s: %I64u events, %I64u events lost, %I64u buffers lost ---\n",
+            Seconds,
+            RealTimeState.Events,
+            RealTimeState.LostEvents,
+            RealTimeState.LostBuffers);
+
+    PrintHistogram(L"Run between switches", &RealTimeState.RunTime, Seconds);
+    PrintHistogram(L"Disk read latency", &RealTimeState.DiskRead, Seconds);
+    PrintHistogram(L"Disk write latency", &RealTimeState.DiskWrite, Seconds);
+    PrintHistogram(L"DPC time", &RealTimeState.Dpc, Seconds);
+    PrintHistogram(L"ISR time", &RealTimeState.Isr, Seconds);
+    PrintTopModules();
+
+    //
+    // Start the next window.
+    //
+
+    RealTimeState.WindowStart = Timestamp;
+    RealTimeState.Events = 0;
+    RealTimeState.LostEvents = 0;
+    RealTimeState.LostBuffers = 0;
+    ZeroMemory(&RealTimeState.DiskRead, sizeof(HISTOGRAM));
+    ZeroMemory(&RealTimeState.DiskWrite, sizeof(HISTOGRAM));
+    ZeroMemory(&RealTimeState.RunTime, sizeof(HISTOGRAM));
+    ZeroMemory(&RealTimeState.Dpc, sizeof(HISTOGRAM));
+    ZeroMemory(&RealTimeState.Isr, sizeof(HISTOGRAM));
+
+    for (Index = 0; Index < RealTimeState.ModuleCount; Index += 1) {
+        ZeroMemory(&RealTimeState.Modules[Index].Window, sizeof(MODULE_TIME));
+    }
+
+    ZeroMemory(&RealTimeState.UnknownModule.Window, sizeof(MODULE_TIME));
+}
+
+VOID
+WINAPI
+RealTimeEventCallback (
+    _In_ PEVENT_RECORD EventRecord
+    )
+{
+    UCHAR Opcode = EventRecord->EventHeader.EventDescriptor.Opcode;
+    const GUID &ProviderId = EventRecord->EventHeader.ProviderId;
+    LONGLONG Timestamp = EventRecord->EventHeader.TimeStamp.QuadPart;
+
+    RealTimeState.Events += 1;
+    RealTimeState.LastTimestamp = Timestamp;
+
+    //
+    // Context switches are by far the most frequent, so they are tested
+    // first.
+    //
+
+    if (ProviderId == ThreadGuid) {
+        if (Opcode == CSWITCH_OPCODE) {
+            OnContextSwitch(EventRecord);
+        }
+
+    } else if (ProviderId == PerfInfoGuid) {
+        if (Opcode == THREADED_DPC_OPCODE || Opcode == ISR_OPCODE ||
+            Opcode == DPC_OPCODE || Opcode == TIMER_DPC_OPCODE) {
+            OnDpcOrIsr(EventRecord);
+        }
+
+    } else if (ProviderId == DiskIoGuid) {
+        if (Opcode == DISK_READ_OPCODE || Opcode == DISK_WRITE_OPCODE) {
+            OnDiskIo(EventRecord);
+        }
+
+    } else if (ProviderId == ImageLoadGuid) {
+        if (Opcode == EVENT_TRACE_TYPE_LOAD || Opcode == EVENT_TRACE_TYPE_DC_START) {
+            OnImageLoad(EventRecord);
+        }
+
+    } else if (ProviderId == RTLostEventsGuid) {
+        if (Opcode == RT_LOST_EVENT_OPCODE) {
+            RealTimeState.LostEvents += 1;
+
+        } else if (Opcode == RT_LOST_BUFFER_OPCODE) {
+            RealTimeState.LostBuffers += 1;
+        }
+    }
+
+    if (RealTimeState.WindowStart == 0) {
+        RealTimeState.WindowStart = Timestamp;
+
+    } else if (Timestamp - RealTimeState.WindowStart >= RealTimeState.SummaryTicks) {
+        PrintSummary(Timestamp);
+    }
+}
+
+DWORD
+WINAPI
+RealTimeConsumerThread (
+    _In_ LPVOID Parameter
+    )
+{
+    return ProcessTrace((PTRACEHANDLE)Parameter, 1, NULL, NULL);
+}
+
+BOOL
+WINAPI
+RealTimeCtrlHandler (
+    _In_ DWORD CtrlType
+    )
+{
+    if (CtrlType == CTRL_C_EVENT || CtrlType == CTRL_BREAK_EVENT) {
+        SetEvent(RealTimeStopEvent);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+ULONG
+RealTimeTrace (
+    _In_ ULONG Seconds,
+    _In_ ULONG SummarySeconds
+    )
+{
+    TRACEHANDLE ConsumerHandle = INVALID_PROCESSTRACE_HANDLE;
+    HANDLE ConsumerThread = NULL;
+    LARGE_INTEGER Frequency;
+    EVENT_TRACE_LOGFILE LogFile;
+    PWSTR LoggerName = L"MyRealTimeTrace";
+    TRACEHANDLE SessionHandle = 0;
+    ULONG Status = ERROR_SUCCESS;
+    ULONG SystemTraceFlags[8];
+    PEVENT_TRACE_PROPERTIES TraceProperties;
+    HANDLE WaitHandles[2];
+
+    TraceProperties = AllocateTraceProperties(NULL, NULL);
+    if (TraceProperties == NULL) {
+        Status = ERROR_OUTOFMEMORY;
+        goto Exit;
+    }
+
+    StringCchCopy(RealTimeState.UnknownModule.Name, MAXIMUM_MODULE_NAME, L"(unknown)");
+
+    RealTimeState.ProcessorCount = GetMaximumProcessorCount(ALL_PROCESSOR_GROUPS);
+    RealTimeState.LastSwitch = (PLONGLONG)calloc(RealTimeState.ProcessorCount,
+                                                 sizeof(LONGLONG));
+
+    RealTimeStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+    if (RealTimeState.LastSwitch == NULL || RealTimeStopEvent == NULL) {
+        Status = ERROR_OUTOFMEMORY;
+        goto Exit;
+    }
+
+    //
+    // Deliver buffers to this process instead of a file, and flush them
+    // every second so the summaries stay current.
+    //
+
+    TraceProperties->LogFileNameOffset = 0;
+    TraceProperties->LogFileMode = EVENT_TRACE_REAL_TIME_MODE | EVENT_TRACE_SYSTEM_LOGGER_MODE;
+    TraceProperties->Wnode.ClientContext = 1; // Use QueryPerformanceCounter for time stamps
+    TraceProperties->BufferSize = 64; // Use 64KB trace buffers
+    TraceProperties->MinimumBuffers = 64;
+    TraceProperties->MaximumBuffers = 256;
+    TraceProperties->FlushTimer = 1;
+
+    Status = StartTrace(&SessionHandle, LoggerName, TraceProperties);
+    if (Status != ERROR_SUCCESS) {
+        wprintf(L"StartTrace() failed with %lu\n", Status);
+        SessionHandle = 0;
+        goto Exit;
+    }
+
+    //
+    // Enable context switches, disk I/O, DPCs, interrupts and the image
+    // loads needed to attribute DPC and ISR routines to modules.
+    //
+
+    ZeroMemory(SystemTraceFlags, sizeof(SystemTraceFlags));
+    SystemTraceFlags[0] = (EVENT_TRACE_FLAG_CSWITCH |
+                           EVENT_TRACE_FLAG_DISK_IO |
+                           EVENT_TRACE_FLAG_DPC |
+                           EVENT_TRACE_FLAG_INTERRUPT |
+                           EVENT_TRACE_FLAG_IMAGE_LOAD);
+
+    Status = TraceSetInformation(SessionHandle,
+                                 TraceSystemTraceEnableFlagsInfo,
+                                 SystemTraceFlags,
+                                 sizeof(SystemTraceFlags));
+
+    if (Status != ERROR_SUCCESS) {
+        wprintf(L"TraceSetInformation(EnableFlags) failed with %lu\n", Status);
+        goto Exit;
+    }
+
+    //
+    // Open the session for real-time consumption. Raw time stamps keep the
+    // event time stamps in the same units as the times inside the events.
+    //
+
+    ZeroMemory(&LogFile, sizeof(LogFile));
+    LogFile.LoggerName = LoggerName;
+    LogFile.ProcessTraceMode = (PROCESS_TRACE_MODE_REAL_TIME |
+                                PROCESS_TRACE_MODE_EVENT_RECORD |
+                                PROCESS_TRACE_MODE_RAW_TIMESTAMP);
+    LogFile.EventRecordCallback = RealTimeEventCallback;
+
+    ConsumerHandle = OpenTrace(&LogFile);
+    if (ConsumerHandle == INVALID_PROCESSTRACE_HANDLE) {
+        Status = GetLastError();
+        wprintf(L"OpenTrace() failed with %lu\n", Status);
+        goto Exit;
+    }
+
+    RealTimeState.Frequency = LogFile.LogfileHeader.PerfFreq.QuadPart;
+    if (RealTimeState.Frequency == 0) {
+        QueryPerformanceFrequency(&Frequency);
+        RealTimeState.Frequency = Frequency.QuadPart;
+    }
+
+    RealTimeState.SummaryTicks = RealTimeState.Frequency * SummarySeconds;
+
+    ConsumerThread = CreateThread(NULL, 0, RealTimeConsumerThread, &ConsumerHandle, 0, NULL);
+    if (ConsumerThread == NULL) {
+        Status = GetLastError();
+        wprintf(L"CreateThread() failed with %lu\n", Status);
+        goto Exit;
+    }
+
+    SetConsoleCtrlHandler(RealTimeCtrlHandler, TRUE);
+
+    wprintf(L"Collecting for %lu seconds, summary every %lu seconds. Press Ctrl+C to stop.\n",
+            Seconds,
+            SummarySeconds);
+
+    WaitHandles[0] = RealTimeStopEvent;
+    WaitHandles[1] = ConsumerThread;
+    WaitForMultipleObjects(2, WaitHandles, FALSE, Seconds * 1000);
+
+Exit:
+
+    //
+    // Stopping the session delivers the remaining buffers, after which
+    // ProcessTrace returns.
+    //
+
+    if (SessionHandle != 0) {
+        if (ControlTrace(SessionHandle, NULL, TraceProperties, EVENT_TRACE_CONTROL_STOP) == ERROR_SUCCESS) {
+            wprintf(L"\nSession: %lu events lost, %lu real-time buffers lost\n",
+                    TraceProperties->EventsLost,
+                    TraceProperties->RealTimeBuffersLost);
+        } else {
+            wprintf(L"StopTrace() failed\n");
+        }
+    }
+
+    if (ConsumerThread != NULL) {
+        WaitForSingleObject(ConsumerThread, INFINITE);
+        CloseHandle(ConsumerThread);
+
+        if (RealTimeState.Events != 0) {
+            PrintSummary(RealTimeState.LastTimestamp);
+        }
+    }
+
+    if (ConsumerHandle != INVALID_PROCESSTRACE_HANDLE) {
+        CloseTrace(ConsumerHandle);
+    }
+
+    SetConsoleCtrlHandler(RealTimeCtrlHandler, FALSE);
+
+    if (RealTimeStopEvent != NULL) {
+        CloseHandle(RealTimeStopEvent);
+    }
+
+    free(RealTimeState.LastSwitch);
+
+    if (TraceProperties != NULL) {
+        FreeTraceProperties(TraceProperties);
+    }
+
+    return Status;
+}
+
 int
 __cdecl
-wmain()
+wmain(
+    _In_ int argc,
+    _In_reads_(argc) PWSTR argv[]
+    )
 {
     CLASSIC_EVENT_ID EventId[2];
     ULONG Status = ERROR_SUCCESS;
@@ -115,9 +925,38 @@ wmain()
     PEVENT_TRACE_PROPERTIES TraceProperties;
     ULONG SystemTraceFlags[8];
     PWSTR LoggerName = L"MyTrace";
+    ULONG Seconds;
+    ULONG SummarySeconds;
 
     HeapSetInformation(NULL, HeapEnableTerminationOnCorruption, NULL, 0);
 
+    //
+    // SystemTraceControl -realtime [seconds [summary seconds]] consumes the
+    // events live instead of writing them to a file.
+    //
+
+    if (argc > 1) {
+        Seconds = DEFAULT_REALTIME_SECONDS;
+        SummarySeconds = DEFAULT_SUMMARY_SECONDS;
+
+        if (argc > 2) {
+            Seconds = wcstoul(argv[2], NULL, 10);
+        }
+
+        if (argc > 3) {
+            SummarySeconds = wcstoul(argv[3], NULL, 10);
+        }
+
+        if (_wcsicmp(argv[1], L"-realtime") != 0 || argc > 4 ||
+            Seconds == 0 || SummarySeconds == 0) {
+
+            wprintf(L"Usage: SystemTraceControl [-realtime [seconds [summary seconds]]]\n");
+            return ERROR_INVALID_PARAMETER;
+        }
+
+        return RealTimeTrace(Seconds, SummarySeconds);
+    }
+
     //
     // Allocate EVENT_TRACE_PROPERTIES structure and perform some
     // basic initialization. 
@@ -29,6 +29,55 @@ Abstract:
     CTL_CODE( FILE_DEVICE_UNKNOWN, 0x801,   \
         METHOD_BUFFERED, FILE_ANY_ACCESS )
 
+//
+// Runs a loop of simulated hot-path events in the driver, traced through the
+// per-processor staging buffers of hotpath.c. The input buffer holds a
+// HOTPATH_RUN_INPUT and the output buffer receives a HOTPATH_RUN_OUTPUT.
+//
+#define IOCTL_EVNTKMP_HOTPATH_RUN           \
+    CTL_CODE( FILE_DEVICE_UNKNOWN, 0x802,   \
+        METHOD_BUFFERED, FILE_ANY_ACCESS )
+
+//
+// How each event of the run is traced. HOTPATH_MODE_NONE measures the cost
+// of the loop itself; Parameter is the sampling rate (1 event in Parameter
+// is kept) or the rate limit (records per processor per 10 ms window).
+//
+#define HOTPATH_MODE_NONE           0
+#define HOTPATH_MODE_ALL            1
+#define HOTPATH_MODE_SAMPLED        2
+#define HOTPATH_MODE_RATE_LIMITED   3
+
+#define HOTPATH_MAX_RUN_EVENTS      100000000
+
+//
+// Keyword of the HotPathBatch event in evntdrv.xml. A session must enable
+// it for the hot path to stage any record.
+//
+#define EVNTKMP_HOTPATH_KEYWORD     0x1
+
+typedef struct _HOTPATH_RUN_INPUT {
+    ULONG Events;
+    ULONG Mode;
+    ULONG Parameter;
+} HOTPATH_RUN_INPUT, *PHOTPATH_RUN_INPUT;
+
+typedef struct _HOTPATH_STATISTICS {
+    ULONG64 Staged;             // records placed in a staging buffer
+    ULONG64 SampledOut;         // events skipped by sampling
+    ULONG64 RateLimited;        // events skipped by the rate limit
+    ULONG64 Batches;            // batch events written successfully
+    ULONG64 WriteFailures;      // batch events ETW could not write
+    ULONG64 LostRecords;        // records in the failed batches
+} HOTPATH_STATISTICS, *PHOTPATH_STATISTICS;
+
+typedef struct _HOTPATH_RUN_OUTPUT {
+    ULONG64 ElapsedTicks;
+    ULONG64 Frequency;
+    ULONG64 Checksum;
+    HOTPATH_STATISTICS Statistics;
+} HOTPATH_RUN_OUTPUT, *PHOTPATH_RUN_OUTPUT;
+
 #endif // __EVENTKMP_IOCTL__
 
 
@@ -29,6 +29,7 @@ Abstract:
 // The file contains a macro per event, and the required code to raise the 
 // event.
 #include "evntdrvEvents.h"  
+#include "hotpath.h"
 
 
 DRIVER_UNLOAD EventDrvDriverUnload;
@@ -62,12 +63,19 @@ EventDrvDriverUnload(
     IN PDRIVER_OBJECT DriverObject
     );
 
+NTSTATUS
+EventDrvHotPathRun(
+    IN PHOTPATH_RUN_INPUT Input,
+    OUT PHOTPATH_RUN_OUTPUT Output
+    );
+
 
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text( INIT, DriverEntry )
 #pragma alloc_text( PAGE, EventDrvDispatchOpenClose )
 #pragma alloc_text( PAGE, EventDrvDispatchDeviceControl )
 #pragma alloc_text( PAGE, EventDrvDriverUnload )
+#pragma alloc_text( PAGE, EventDrvHotPathRun )
 #endif // ALLOC_PRAGMA
 
 
@@ -153,6 +161,15 @@ Return Value:
     //
     EventRegisterSample_Driver();
 
+    Status = HotPathInitialize();
+
+    if (!NT_SUCCESS(Status)) {
+        EventUnregisterSample_Driver();
+        IoDeleteSymbolicLink( &LinkName );
+        IoDeleteDevice( EventDrvDeviceObject );
+        return Status;
+    }
+
     //
     // Log an Event with :  DeviceNameLength
     //                      DeviceName
@@ -262,6 +279,28 @@ Return Value:
         break;
     }
 
+    case IOCTL_EVNTKMP_HOTPATH_RUN:
+    {
+        if (irpStack->Parameters.DeviceIoControl.InputBufferLength <
+                sizeof(HOTPATH_RUN_INPUT) ||
+            irpStack->Parameters.DeviceIoControl.OutputBufferLength <
+                sizeof(HOTPATH_RUN_OUTPUT)) {
+
+            Irp->IoStatus.Status = STATUS_BUFFER_TOO_SMALL;
+            Irp->IoStatus.Information = 0;
+            break;
+        }
+
+        Irp->IoStatus.Status = EventDrvHotPathRun(
+                                   Irp->AssociatedIrp.SystemBuffer,
+                                   Irp->AssociatedIrp.SystemBuffer);
+
+        Irp->IoStatus.Information = NT_SUCCESS(Irp->IoStatus.Status) ?
+                                        sizeof(HOTPATH_RUN_OUTPUT) : 0;
+
+        break;
+    }
+
     default:
         
         //
@@ -277,12 +316,109 @@ Return Value:
     //
     // Get rid of this request
     //
+    Status = Irp->IoStatus.Status;
     IoCompleteRequest( Irp, IO_NO_INCREMENT );
 
     return Status;
 }
 
 
+NTSTATUS
+EventDrvHotPathRun(
+    IN PHOTPATH_RUN_INPUT Input,
+    OUT PHOTPATH_RUN_OUTPUT Output
+    )
+/*++
+
+Routine Description:
+
+    Runs a loop of simulated hot-path events and traces each one as the
+    caller asked. Each event does a little work of its own, so a run with
+    HOTPATH_MODE_NONE gives the cost of the loop without tracing.
+
+    The records still staged at the end are written out before the
+    statistics are collected.
+
+Arguments:
+
+    Input - parameters of the run.
+
+    Output - receives the duration of the run and the tracing statistics.
+        It may share its buffer with Input.
+
+Return Value:
+
+    NT status code
+
+--*/
+{
+    ULONG64 Checksum = 0;
+    LARGE_INTEGER End;
+    ULONG Event;
+    LARGE_INTEGER Frequency;
+    HOTPATH_RUN_INPUT Run;
+    ULONG Seed = 1;
+    LARGE_INTEGER Start;
+
+    PAGED_CODE();
+
+    Run = *Input;
+
+    if (Run.Events == 0 || Run.Events > HOTPATH_MAX_RUN_EVENTS ||
+        Run.Mode > HOTPATH_MODE_RATE_LIMITED) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if ((Run.Mode == HOTPATH_MODE_SAMPLED ||
+         Run.Mode == HOTPATH_MODE_RATE_LIMITED) && Run.Parameter == 0) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    HotPathResetStatistics();
+
+    Start = KeQueryPerformanceCounter(&Frequency);
+
+    for (Event = 0; Event < Run.Events; Event += 1) {
+
+        //
+        // The simulated work of the event: a linear congruential step.
+        //
+
+        Seed = Seed * 1664525 + 1013904223;
+        Checksum += Seed >> 8;
+
+        switch (Run.Mode) {
+        case HOTPATH_MODE_ALL:
+            HotPathTrace(Event & 0xF, Seed);
+            break;
+
+        case HOTPATH_MODE_SAMPLED:
+            HotPathTraceSampled(Event & 0xF, Seed, Run.Parameter);
+            break;
+
+        case HOTPATH_MODE_RATE_LIMITED:
+            HotPathTraceRateLimited(Event & 0xF, Seed, Run.Parameter);
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    End = KeQueryPerformanceCounter(NULL);
+
+    HotPathFlush();
+
+    RtlZeroMemory(Output, sizeof(*Output));
+    Output->ElapsedTicks = (ULONG64)(End.QuadPart - Start.QuadPart);
+    Output->Frequency = (ULONG64)Frequency.QuadPart;
+    Output->Checksum = Checksum;
+    HotPathQueryStatistics(&Output->Statistics);
+
+    return STATUS_SUCCESS;
+}
+
+
 VOID
 EventDrvDriverUnload(
     IN PDRIVER_OBJECT DriverObject
@@ -317,6 +453,13 @@ Return Value:
     DevObj = DriverObject->DeviceObject;
 
     EventWriteUnloadEvent(NULL, DevObj);
+
+    //
+    // Write out the hot path records still staged while the provider is
+    // registered.
+    //
+    HotPathFlush();
+    HotPathUninitialize();
     
     //
     //  Unregister the driver as an ETW provider
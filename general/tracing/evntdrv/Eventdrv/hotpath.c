@@ -0,0 +1,455 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+
+Module Name:
+
+    hotpath.c
+
+Abstract:
+
+    Hot path tracing helper: per-processor staging buffers written as
+    batched HotPathBatch events.
+
+    A staging buffer is only touched by its own processor at
+    DISPATCH_LEVEL, so records are staged without locks or interlocked
+    operations. The statistics are kept the same way and summed on query.
+
+
+--*/
+#include <ntddk.h>
+#include "drvioctl.h"
+#include "evntdrvEvents.h"
+#include "hotpath.h"
+
+
+//
+// Staging buffer of one processor. The structure is cache aligned, so the
+// buffers of two processors never share a cache line.
+//
+typedef struct DECLSPEC_CACHEALIGN _HOTPATH_BUFFER {
+
+    ULONG Count;
+    ULONG Sequence;
+
+    //
+    // Records lost on this processor since the last batch written. Reported
+    // in the next batch so a consumer can tell where the gaps are.
+    //
+    ULONG Dropped;
+
+    ULONG SampleCountdown;
+    ULONG WindowCount;
+    ULONG64 WindowStart;
+
+    HOTPATH_STATISTICS Statistics;
+
+    HOTPATH_RECORD Records[HOTPATH_BATCH_RECORDS];
+
+} HOTPATH_BUFFER, *PHOTPATH_BUFFER;
+
+PHOTPATH_BUFFER HotPathBuffers;
+ULONG HotPathProcessorCount;
+ULONG64 HotPathRateWindow;
+
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text( PAGE, HotPathInitialize )
+#pragma alloc_text( PAGE, HotPathUninitialize )
+#pragma alloc_text( PAGE, HotPathFlush )
+#pragma alloc_text( PAGE, HotPathResetStatistics )
+#endif // ALLOC_PRAGMA
+
+
+NTSTATUS
+HotPathInitialize(
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Allocates a staging buffer for every processor the system can have.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    NT status code
+
+--*/
+{
+    LARGE_INTEGER Frequency;
+    SIZE_T Size;
+
+    PAGED_CODE();
+
+    HotPathProcessorCount = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    Size = sizeof(HOTPATH_BUFFER) * (SIZE_T)HotPathProcessorCount;
+
+    HotPathBuffers = ExAllocatePoolWithTag(NonPagedPoolNxCacheAligned,
+                                           Size,
+                                           HOTPATH_POOL_TAG);
+    if (HotPathBuffers == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(HotPathBuffers, Size);
+
+    KeQueryPerformanceCounter(&Frequency);
+    HotPathRateWindow = (ULONG64)Frequency.QuadPart * HOTPATH_RATE_WINDOW_MS / 1000;
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+HotPathUninitialize(
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Frees the staging buffers. Nothing may trace any more; records still
+    staged are discarded, so call HotPathFlush first to keep them.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    VOID.
+
+--*/
+{
+    PHOTPATH_BUFFER Buffers = HotPathBuffers;
+
+    PAGED_CODE();
+
+    if (Buffers == NULL) {
+        return;
+    }
+
+    HotPathBuffers = NULL;
+    ExFreePoolWithTag(Buffers, HOTPATH_POOL_TAG);
+}
+
+
+VOID
+HotPathWriteBatch(
+    _Inout_ PHOTPATH_BUFFER Buffer,
+    _In_ ULONG Processor
+    )
+/*++
+
+Routine Description:
+
+    Writes the records staged in a buffer as one HotPathBatch event and
+    empties the buffer. The caller runs at DISPATCH_LEVEL on the processor
+    that owns the buffer.
+
+    If ETW has no free buffer the event is lost; the records are counted
+    as lost and reported in the Dropped field of the next batch.
+
+Arguments:
+
+    Buffer - staging buffer of the current processor.
+
+    Processor - index of the current processor.
+
+Return Value:
+
+    VOID.
+
+--*/
+{
+    EVENT_DATA_DESCRIPTOR EventData[4];
+    NTSTATUS Status;
+
+    if (Buffer->Count == 0) {
+        return;
+    }
+
+    EventDataDescCreate(&EventData[0], &Processor, sizeof(ULONG));
+    EventDataDescCreate(&EventData[1], &Buffer->Dropped, sizeof(ULONG));
+    EventDataDescCreate(&EventData[2], &Buffer->Count, sizeof(ULONG));
+    EventDataDescCreate(&EventData[3],
+                        Buffer->Records,
+                        Buffer->Count * (ULONG)sizeof(HOTPATH_RECORD));
+
+    Status = EtwWriteTransfer(Sample_DriverHandle,
+                              &HotPathBatch,
+                              NULL,
+                              NULL,
+                              (ULONG)RTL_NUMBER_OF(EventData),
+                              EventData);
+
+    if (NT_SUCCESS(Status)) {
+        Buffer->Statistics.Batches += 1;
+        Buffer->Dropped = 0;
+
+    } else {
+        Buffer->Statistics.WriteFailures += 1;
+        Buffer->Statistics.LostRecords += Buffer->Count;
+        Buffer->Dropped += Buffer->Count;
+    }
+
+    Buffer->Count = 0;
+}
+
+
+VOID
+HotPathStage(
+    _In_ ULONG Id,
+    _In_ ULONG64 Value,
+    _In_ HOTPATH_FILTER Filter,
+    _In_ ULONG Parameter
+    )
+/*++
+
+Routine Description:
+
+    Applies the sampling or rate limit filter and stages a record in the
+    buffer of the current processor, writing the buffer out when it fills.
+
+    Below DISPATCH_LEVEL the IRQL is raised so the thread stays on the
+    processor whose buffer it updates.
+
+Arguments:
+
+    Id - caller-defined identifier of the record.
+
+    Value - caller-defined value of the record.
+
+    Filter - how the call is filtered.
+
+    Parameter - sampling rate or rate limit, depending on Filter.
+
+Return Value:
+
+    VOID.
+
+--*/
+{
+    PHOTPATH_BUFFER Buffer;
+    KIRQL OldIrql = DISPATCH_LEVEL;
+    ULONG Processor;
+    BOOLEAN Raised = FALSE;
+    PHOTPATH_RECORD Record;
+    LARGE_INTEGER Timestamp;
+
+    if (HotPathBuffers == NULL) {
+        return;
+    }
+
+    if (KeGetCurrentIrql() < DISPATCH_LEVEL) {
+        KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+        Raised = TRUE;
+    }
+
+    Processor = KeGetCurrentProcessorIndex();
+    Buffer = &HotPathBuffers[Processor];
+
+    //
+    // Sampling is decided with a countdown, before the clock is read, so
+    // a skipped call costs a decrement.
+    //
+
+    if (Filter == HotPathFilterSample) {
+        if (Buffer->SampleCountdown > 1) {
+            Buffer->SampleCountdown -= 1;
+            Buffer->Statistics.SampledOut += 1;
+            goto Exit;
+        }
+
+        Buffer->SampleCountdown = Parameter;
+    }
+
+    Timestamp = KeQueryPerformanceCounter(NULL);
+
+    if (Filter == HotPathFilterRateLimit) {
+        if ((ULONG64)Timestamp.QuadPart - Buffer->WindowStart >= HotPathRateWindow) {
+            Buffer->WindowStart = (ULONG64)Timestamp.QuadPart;
+            Buffer->WindowCount = 0;
+        }
+
+        if (Buffer->WindowCount >= Parameter) {
+            Buffer->Statistics.RateLimited += 1;
+            goto Exit;
+        }
+
+        Buffer->WindowCount += 1;
+    }
+
+    Record = &Buffer->Records[Buffer->Count];
+    Record->Timestamp = (ULONG64)Timestamp.QuadPart;
+    Record->Value = Value;
+    Record->Id = Id;
+    Record->Sequence = Buffer->Sequence;
+
+    Buffer->Sequence += 1;
+    Buffer->Count += 1;
+    Buffer->Statistics.Staged += 1;
+
+    if (Buffer->Count == HOTPATH_BATCH_RECORDS) {
+        HotPathWriteBatch(Buffer, Processor);
+    }
+
+Exit:
+    if (Raised) {
+        KeLowerIrql(OldIrql);
+    }
+}
+
+
+VOID
+HotPathFlush(
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Writes out the records staged on every processor. The thread moves to
+    each processor with a partially filled buffer in turn, since only the
+    owner of a buffer may touch it.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    VOID.
+
+--*/
+{
+    GROUP_AFFINITY Affinity;
+    ULONG Index;
+    KIRQL OldIrql;
+    GROUP_AFFINITY OldAffinity;
+    PROCESSOR_NUMBER ProcessorNumber;
+
+    PAGED_CODE();
+
+    if (HotPathBuffers == NULL) {
+        return;
+    }
+
+    for (Index = 0; Index < HotPathProcessorCount; Index += 1) {
+
+        //
+        // A processor that never staged a record has nothing to write; this
+        // also skips the processors that are not active.
+        //
+
+        if (HotPathBuffers[Index].Count == 0) {
+            continue;
+        }
+
+        if (!NT_SUCCESS(KeGetProcessorNumberFromIndex(Index, &ProcessorNumber))) {
+            continue;
+        }
+
+        RtlZeroMemory(&Affinity, sizeof(Affinity));
+        Affinity.Group = ProcessorNumber.Group;
+        Affinity.Mask = (KAFFINITY)1 << ProcessorNumber.Number;
+
+        KeSetSystemGroupAffinityThread(&Affinity, &OldAffinity);
+        KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+
+        HotPathWriteBatch(&HotPathBuffers[Index], Index);
+
+        KeLowerIrql(OldIrql);
+        KeRevertToUserGroupAffinityThread(&OldAffinity);
+    }
+}
+
+
+VOID
+HotPathResetStatistics(
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Clears the statistics of every processor. Only exact while nothing is
+    tracing.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    VOID.
+
+--*/
+{
+    ULONG Index;
+
+    PAGED_CODE();
+
+    if (HotPathBuffers == NULL) {
+        return;
+    }
+
+    for (Index = 0; Index < HotPathProcessorCount; Index += 1) {
+        RtlZeroMemory(&HotPathBuffers[Index].Statistics,
+                      sizeof(HOTPATH_STATISTICS));
+    }
+}
+
+
+VOID
+HotPathQueryStatistics(
+    _Out_ PHOTPATH_STATISTICS Statistics
+    )
+/*++
+
+Routine Description:
+
+    Sums the statistics of all processors. While other processors trace,
+    the result is a snapshot rather than an exact value.
+
+Arguments:
+
+    Statistics - receives the totals.
+
+Return Value:
+
+    VOID.
+
+--*/
+{
+    volatile HOTPATH_STATISTICS *Processor;
+    ULONG Index;
+
+    RtlZeroMemory(Statistics, sizeof(*Statistics));
+
+    if (HotPathBuffers == NULL) {
+        return;
+    }
+
+    for (Index = 0; Index < HotPathProcessorCount; Index += 1) {
+        Processor = &HotPathBuffers[Index].Statistics;
+
+        Statistics->Staged += Processor->Staged;
+        Statistics->SampledOut += Processor->SampledOut;
+        Statistics->RateLimited += Processor->RateLimited;
+        Statistics->Batches += Processor->Batches;
+        Statistics->WriteFailures += Processor->WriteFailures;
+        Statistics->LostRecords += Processor->LostRecords;
+    }
+}
@@ -0,0 +1,159 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+
+Module Name:
+
+    hotpath.h
+
+Abstract:
+
+    Interface of the hot path tracing helper.
+
+    Writing one ETW event per operation costs too much on a path that runs
+    a million times a second. The helper stages small fixed-size records in
+    a buffer private to each processor and writes them as one HotPathBatch
+    event when the buffer is full, so the cost of EtwWriteTransfer is shared
+    by HOTPATH_BATCH_RECORDS records.
+
+    The HotPathTrace routines check EventEnabledHotPathBatch, the enable
+    check MC generates for the event, before doing anything else. While no
+    session enables the HotPath keyword a trace point costs one test of the
+    provider's enable bits.
+
+    Callers must run at IRQL <= DISPATCH_LEVEL.
+
+--*/
+
+#ifndef __EVENTKMP_HOTPATH__
+#define __EVENTKMP_HOTPATH__
+
+//
+// Records carried by one HotPathBatch event. A full batch is 1.5 KB of
+// payload, well below the size of an ETW buffer.
+//
+#define HOTPATH_BATCH_RECORDS       64
+
+//
+// Length of the window the rate limit counts records in.
+//
+#define HOTPATH_RATE_WINDOW_MS      10
+
+#define HOTPATH_POOL_TAG            'pHvE'
+
+//
+// One record, laid out as the Records structure of the HotPathBatch event
+// in evntdrv.xml.
+//
+typedef struct _HOTPATH_RECORD {
+    ULONG64 Timestamp;
+    ULONG64 Value;
+    ULONG Id;
+    ULONG Sequence;
+} HOTPATH_RECORD, *PHOTPATH_RECORD;
+
+C_ASSERT(sizeof(HOTPATH_RECORD) == 24);
+
+typedef enum _HOTPATH_FILTER {
+    HotPathFilterNone = 0,
+    HotPathFilterSample,
+    HotPathFilterRateLimit
+} HOTPATH_FILTER;
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+HotPathInitialize(
+    VOID
+    );
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+HotPathUninitialize(
+    VOID
+    );
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+HotPathFlush(
+    VOID
+    );
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+HotPathResetStatistics(
+    VOID
+    );
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+HotPathQueryStatistics(
+    _Out_ PHOTPATH_STATISTICS Statistics
+    );
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+HotPathStage(
+    _In_ ULONG Id,
+    _In_ ULONG64 Value,
+    _In_ HOTPATH_FILTER Filter,
+    _In_ ULONG Parameter
+    );
+
+//
+// Stages a record for every call.
+//
+_IRQL_requires_max_(DISPATCH_LEVEL)
+FORCEINLINE
+VOID
+HotPathTrace(
+    _In_ ULONG Id,
+    _In_ ULONG64 Value
+    )
+{
+    if (EventEnabledHotPathBatch()) {
+        HotPathStage(Id, Value, HotPathFilterNone, 0);
+    }
+}
+
+//
+// Stages a record for one call in SampleRate on each processor.
+//
+_IRQL_requires_max_(DISPATCH_LEVEL)
+FORCEINLINE
+VOID
+HotPathTraceSampled(
+    _In_ ULONG Id,
+    _In_ ULONG64 Value,
+    _In_ ULONG SampleRate
+    )
+{
+    if (EventEnabledHotPathBatch()) {
+        HotPathStage(Id, Value, HotPathFilterSample, SampleRate);
+    }
+}
+
+//
+// Stages at most Limit records per processor in each HOTPATH_RATE_WINDOW_MS
+// window and skips the calls beyond that.
+//
+_IRQL_requires_max_(DISPATCH_LEVEL)
+FORCEINLINE
+VOID
+HotPathTraceRateLimited(
+    _In_ ULONG Id,
+    _In_ ULONG64 Value,
+    _In_ ULONG Limit
+    )
+{
+    if (EventEnabledHotPathBatch()) {
+        HotPathStage(Id, Value, HotPathFilterRateLimit, Limit);
+    }
+}
+
+#endif // __EVENTKMP_HOTPATH__
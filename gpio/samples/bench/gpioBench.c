@@ -0,0 +1,685 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    gpioBench.c
+
+Abstract:
+
+    A benchmark of the calls SimGpio takes per GPIO operation.
+
+    It builds simgpiobank.c from the simgpio directory and drives its
+    callbacks the way GpioClx does for two kinds of peripheral driver: one
+    that sends a request per pin, and one that sends a request for a whole
+    bus, which GpioClx hands to SimGpio as one bitmask per bank. The
+    operations are writing and reading a byte on an 8-line bus, within a
+    bank and across two banks, and servicing 1, 4 and 32 interrupts that
+    assert at once on a bank, pin by pin or with one query and one clear
+    for the bank.
+
+    For each it reports the SimGpio callbacks per operation, from the
+    bank statistics the driver keeps, the register accesses per operation,
+    and the time per operation, and checks that both ways leave the
+    registers in the same state and service the same pins.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_code_)
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "gpioBench.h"
+#include "simgpio.h"
+
+#define DEFAULT_MILLISECONDS    200
+
+#define BUS_WIDTH               8
+
+typedef
+ULONG
+(*PBENCH_OPERATION_ROUTINE) (
+    _In_ PSIM_GPIO_CONTEXT GpioContext,
+    _In_ ULONG Argument,
+    _In_ ULONG Value
+    );
+
+typedef struct _BENCH_OPERATION {
+    PCSTR Name;
+    ULONG Argument;
+    PBENCH_OPERATION_ROUTINE PinByPin;
+    PBENCH_OPERATION_ROUTINE BankMask;
+} BENCH_OPERATION, *PBENCH_OPERATION;
+
+typedef struct _BENCH_COUNTS {
+    ULONG Calls;
+    ULONG RegisterAccesses;
+} BENCH_COUNTS, *PBENCH_COUNTS;
+
+ULONG BenchRegisterAccesses;
+
+ULONG BenchFailures;
+
+SIM_GPIO_REGISTERS BenchRegisters[SIM_GPIO_TOTAL_BANKS];
+
+SIM_GPIO_CONTEXT BenchContext;
+
+LARGE_INTEGER Frequency;
+
+//
+// ----------------------------------------------------- GpioClx style requests
+//
+
+VOID
+WritePins (
+    _In_ PSIM_GPIO_CONTEXT GpioContext,
+    _In_ BANK_ID BankId,
+    _In_ ULONG SetMask,
+    _In_ ULONG ClearMask
+    )
+{
+    GPIO_WRITE_PINS_MASK_PARAMETERS WriteParameters;
+
+    RtlZeroMemory(&WriteParameters, sizeof(WriteParameters));
+    WriteParameters.BankId = BankId;
+    WriteParameters.SetMask = SetMask;
+    WriteParameters.ClearMask = ClearMask;
+
+    if (!NT_SUCCESS(SimGpioWriteGpioPins(GpioContext, &WriteParameters))) {
+        BenchFailures += 1;
+    }
+}
+
+ULONG
+ReadPins (
+    _In_ PSIM_GPIO_CONTEXT GpioContext,
+    _In_ BANK_ID BankId
+    )
+{
+    GPIO_READ_PINS_MASK_PARAMETERS ReadParameters;
+    ULONG64 PinValues = 0;
+
+    RtlZeroMemory(&ReadParameters, sizeof(ReadParameters));
+    ReadParameters.BankId = BankId;
+    ReadParameters.PinValues = &PinValues;
+
+    if (!NT_SUCCESS(SimGpioReadGpioPins(GpioContext, &ReadParameters))) {
+        BenchFailures += 1;
+    }
+
+    return (ULONG)PinValues;
+}
+
+ULONG
+QueryActiveInterrupts (
+    _In_ PSIM_GPIO_CONTEXT GpioContext,
+    _In_ BANK_ID BankId,
+    _In_ ULONG EnabledMask
+    )
+{
+    GPIO_QUERY_ACTIVE_INTERRUPTS_PARAMETERS QueryActiveParameters;
+
+    RtlZeroMemory(&QueryActiveParameters, sizeof(QueryActiveParameters));
+    QueryActiveParameters.BankId = BankId;
+    QueryActiveParameters.EnabledMask = EnabledMask;
+
+    if (!NT_SUCCESS(SimGpioQueryActiveInterrupts(GpioContext, &QueryActiveParameters))) {
+        BenchFailures += 1;
+    }
+
+    return (ULONG)QueryActiveParameters.ActiveMask;
+}
+
+VOID
+ClearActiveInterrupts (
+    _In_ PSIM_GPIO_CONTEXT GpioContext,
+    _In_ BANK_ID BankId,
+    _In_ ULONG ClearActiveMask
+    )
+{
+    GPIO_CLEAR_ACTIVE_INTERRUPTS_PARAMETERS ClearParameters;
+
+    RtlZeroMemory(&ClearParameters, sizeof(ClearParameters));
+    ClearParameters.BankId = BankId;
+    ClearParameters.ClearActiveMask = ClearActiveMask;
+
+    if (!NT_SUCCESS(SimGpioClearActiveInterrupts(GpioContext, &ClearParameters)) ||
+        (ClearParameters.FailedClearMask != 0)) {
+
+        BenchFailures += 1;
+    }
+}
+
+//
+// ----------------------------------------------------------------- Operations
+//
+
+ULONG
+BusState (
+    _In_ ULONG FirstPin
+    )
+
+/*++
+
+Routine Description:
+
+    Returns the level of the bus lines starting at FirstPin, read straight
+    from the simulated registers.
+
+--*/
+
+{
+    ULONG Pin;
+    ULONG Index;
+    ULONG Value = 0;
+
+    for (Index = 0; Index < BUS_WIDTH; Index += 1) {
+        Pin = FirstPin + Index;
+        if ((BenchRegisters[Pin / SIM_GPIO_PINS_PER_BANK].LevelRegister &
+             (1UL << (Pin % SIM_GPIO_PINS_PER_BANK))) != 0) {
+
+            Value |= 1UL << Index;
+        }
+    }
+
+    return Value;
+}
+
+VOID
+DriveBus (
+    _In_ ULONG FirstPin,
+    _In_ ULONG Value
+    )
+
+/*++
+
+Routine Description:
+
+    Sets the level of the bus lines starting at FirstPin, as the device on
+    the other end of the bus would.
+
+--*/
+
+{
+    ULONG Pin;
+    ULONG Index;
+    ULONG Bit;
+
+    for (Index = 0; Index < BUS_WIDTH; Index += 1) {
+        Pin = FirstPin + Index;
+        Bit = 1UL << (Pin % SIM_GPIO_PINS_PER_BANK);
+        if ((Value & (1UL << Index)) != 0) {
+            BenchRegisters[Pin / SIM_GPIO_PINS_PER_BANK].LevelRegister |= Bit;
+
+        } else {
+            BenchRegisters[Pin / SIM_GPIO_PINS_PER_BANK].LevelRegister &= ~Bit;
+        }
+    }
+}
+
+ULONG
+WriteBusPinByPin (
+    _In_ PSIM_GPIO_CONTEXT GpioContext,
+    _In_ ULONG FirstPin,
+    _In_ ULONG Value
+    )
+{
+    ULONG Pin;
+    ULONG Index;
+    ULONG Bit;
+
+    for (Index = 0; Index < BUS_WIDTH; Index += 1) {
+        Pin = FirstPin + Index;
+        Bit = 1UL << (Pin % SIM_GPIO_PINS_PER_BANK);
+        WritePins(GpioContext,
+                  (BANK_ID)(Pin / SIM_GPIO_PINS_PER_BANK),
+                  ((Value & (1UL << Index)) != 0) ? Bit : 0,
+                  ((Value & (1UL << Index)) == 0) ? Bit : 0);
+    }
+
+    return BusState(FirstPin);
+}
+
+ULONG
+WriteBusBankMask (
+    _In_ PSIM_GPIO_CONTEXT GpioContext,
+    _In_ ULONG FirstPin,
+    _In_ ULONG Value
+    )
+{
+    ULONG SetMask[SIM_GPIO_TOTAL_BANKS] = {0};
+    ULONG ClearMask[SIM_GPIO_TOTAL_BANKS] = {0};
+    ULONG Pin;
+    ULONG Index;
+    ULONG Bank;
+
+    //
+    // GpioClx splits the request into one set and one clear mask per bank.
+    //
+
+    for (Index = 0; Index < BUS_WIDTH; Index += 1) {
+        Pin = FirstPin + Index;
+        if ((Value & (1UL << Index)) != 0) {
+            SetMask[Pin / SIM_GPIO_PINS_PER_BANK] |= 1UL << (Pin % SIM_GPIO_PINS_PER_BANK);
+
+        } else {
+            ClearMask[Pin / SIM_GPIO_PINS_PER_BANK] |= 1UL << (Pin % SIM_GPIO_PINS_PER_BANK);
+        }
+    }
+
+    for (Bank = 0; Bank < SIM_GPIO_TOTAL_BANKS; Bank += 1) {
+        if ((SetMask[Bank] | ClearMask[Bank]) != 0) {
+            WritePins(GpioContext, (BANK_ID)Bank, SetMask[Bank], ClearMask[Bank]);
+        }
+    }
+
+    return BusState(FirstPin);
+}
+
+ULONG
+ReadBusPinByPin (
+    _In_ PSIM_GPIO_CONTEXT GpioContext,
+    _In_ ULONG FirstPin,
+    _In_ ULONG Value
+    )
+{
+    ULONG Pin;
+    ULONG Index;
+    ULONG Result = 0;
+
+    DriveBus(FirstPin, Value);
+
+    for (Index = 0; Index < BUS_WIDTH; Index += 1) {
+        Pin = FirstPin + Index;
+        if ((ReadPins(GpioContext, (BANK_ID)(Pin / SIM_GPIO_PINS_PER_BANK)) &
+             (1UL << (Pin % SIM_GPIO_PINS_PER_BANK))) != 0) {
+
+            Result |= 1UL << Index;
+        }
+    }
+
+    return Result;
+}
+
+ULONG
+ReadBusBankMask (
+    _In_ PSIM_GPIO_CONTEXT GpioContext,
+    _In_ ULONG FirstPin,
+    _In_ ULONG Value
+    )
+{
+    ULONG PinValues[SIM_GPIO_TOTAL_BANKS];
+    ULONG FirstBank;
+    ULONG LastBank;
+    ULONG Bank;
+    ULONG Pin;
+    ULONG Index;
+    ULONG Result = 0;
+
+    DriveBus(FirstPin, Value);
+
+    FirstBank = FirstPin / SIM_GPIO_PINS_PER_BANK;
+    LastBank = (FirstPin + BUS_WIDTH - 1) / SIM_GPIO_PINS_PER_BANK;
+    for (Bank = FirstBank; Bank <= LastBank; Bank += 1) {
+        PinValues[Bank] = ReadPins(GpioContext, (BANK_ID)Bank);
+    }
+
+    for (Index = 0; Index < BUS_WIDTH; Index += 1) {
+        Pin = FirstPin + Index;
+        if ((PinValues[Pin / SIM_GPIO_PINS_PER_BANK] &
+             (1UL << (Pin % SIM_GPIO_PINS_PER_BANK))) != 0) {
+
+            Result |= 1UL << Index;
+        }
+    }
+
+    return Result;
+}
+
+ULONG
+ServiceInterruptsPinByPin (
+    _In_ PSIM_GPIO_CONTEXT GpioContext,
+    _In_ ULONG AssertingMask,
+    _In_ ULONG Value
+    )
+
+/*++
+
+Routine Description:
+
+    Services the interrupts one pin at a time: each pass queries the bank
+    for the pins still pending, services the lowest and clears it.
+
+--*/
+
+{
+    ULONG Pending;
+    ULONG Active;
+    ULONG Serviced = 0;
+    ULONG Bit;
+
+    UNREFERENCED_PARAMETER(Value);
+
+    BenchRegisters[0].EnableRegister = AssertingMask;
+    Pending = AssertingMask;
+    while (Pending != 0) {
+        Active = QueryActiveInterrupts(GpioContext, 0, Pending);
+        if (Active == 0) {
+            break;
+        }
+
+        Bit = Active & (~Active + 1);
+        Serviced |= Bit;
+        ClearActiveInterrupts(GpioContext, 0, Bit);
+        Pending &= ~Bit;
+    }
+
+    return Serviced;
+}
+
+ULONG
+ServiceInterruptsBankMask (
+    _In_ PSIM_GPIO_CONTEXT GpioContext,
+    _In_ ULONG AssertingMask,
+    _In_ ULONG Value
+    )
+
+/*++
+
+Routine Description:
+
+    Services the interrupts as GpioClx does with SimGpio: one query returns
+    every asserting pin of the bank, all of them are serviced, and one
+    clear acknowledges them together.
+
+--*/
+
+{
+    ULONG Active;
+
+    UNREFERENCED_PARAMETER(Value);
+
+    BenchRegisters[0].EnableRegister = AssertingMask;
+    Active = QueryActiveInterrupts(GpioContext, 0, AssertingMask);
+    if (Active != 0) {
+        ClearActiveInterrupts(GpioContext, 0, Active);
+    }
+
+    return Active;
+}
+
+//
+// Bus pins 16-23 as described in simdevice's GpioSample.asl, and the same
+// bus moved to straddle banks 0 and 1.
+//
+
+const BENCH_OPERATION Operations[] = {
+    { "Write bus",          16,         WriteBusPinByPin,          WriteBusBankMask },
+    { "Write bus 2 banks",  28,         WriteBusPinByPin,          WriteBusBankMask },
+    { "Read bus",           16,         ReadBusPinByPin,           ReadBusBankMask },
+    { "Read bus 2 banks",   28,         ReadBusPinByPin,           ReadBusBankMask },
+    { "1 interrupt",        0x00000010, ServiceInterruptsPinByPin, ServiceInterruptsBankMask },
+    { "4 interrupts",       0x000F0000, ServiceInterruptsPinByPin, ServiceInterruptsBankMask },
+    { "32 interrupts",      0xFFFFFFFF, ServiceInterruptsPinByPin, ServiceInterruptsBankMask },
+};
+
+//
+// ------------------------------------------------------------------ Benchmark
+//
+
+VOID
+ResetController (
+    VOID
+    )
+{
+    ULONG Bank;
+
+    RtlZeroMemory(BenchRegisters, sizeof(BenchRegisters));
+    RtlZeroMemory(&BenchContext, sizeof(BenchContext));
+
+    BenchContext.TotalPins = SIM_GPIO_TOTAL_PINS;
+    for (Bank = 0; Bank < SIM_GPIO_TOTAL_BANKS; Bank += 1) {
+        BenchContext.Banks[Bank].Registers = &BenchRegisters[Bank];
+        BenchContext.Banks[Bank].Length = sizeof(SIM_GPIO_REGISTERS);
+    }
+}
+
+ULONG
+TotalCalls (
+    VOID
+    )
+{
+    PSIM_GPIO_BANK_STATISTICS Statistics;
+    ULONG Bank;
+    ULONG Calls = 0;
+
+    for (Bank = 0; Bank < SIM_GPIO_TOTAL_BANKS; Bank += 1) {
+        Statistics = &BenchContext.Banks[Bank].Statistics;
+        Calls += Statistics->ReadCalls +
+                 Statistics->WriteCalls +
+                 Statistics->QueryActiveCalls +
+                 Statistics->ClearActiveCalls;
+    }
+
+    return Calls;
+}
+
+BOOLEAN
+CheckOperation (
+    _In_ const BENCH_OPERATION *Operation,
+    _Out_ PBENCH_COUNTS PinByPin,
+    _Out_ PBENCH_COUNTS BankMask
+    )
+
+/*++
+
+Routine Description:
+
+    Runs the operation both ways for every byte value, from the same
+    register state, and compares what they return and the registers they
+    leave. Returns the callbacks and register accesses that one operation
+    takes each way.
+
+--*/
+
+{
+    SIM_GPIO_REGISTERS Expected[SIM_GPIO_TOTAL_BANKS];
+    ULONG ExpectedResult;
+    ULONG Value;
+    ULONG Bank;
+    ULONG Calls;
+    ULONG Accesses;
+
+    RtlZeroMemory(PinByPin, sizeof(*PinByPin));
+    RtlZeroMemory(BankMask, sizeof(*BankMask));
+
+    for (Value = 0; Value < 256; Value += 1) {
+        ResetController();
+        Calls = TotalCalls();
+        Accesses = BenchRegisterAccesses;
+        ExpectedResult = Operation->PinByPin(&BenchContext, Operation->Argument, Value);
+        PinByPin->Calls = max(PinByPin->Calls, TotalCalls() - Calls);
+        PinByPin->RegisterAccesses = max(PinByPin->RegisterAccesses, BenchRegisterAccesses - Accesses);
+        RtlCopyMemory(Expected, BenchRegisters, sizeof(Expected));
+
+        ResetController();
+        Calls = TotalCalls();
+        Accesses = BenchRegisterAccesses;
+        if (Operation->BankMask(&BenchContext, Operation->Argument, Value) != ExpectedResult) {
+            return FALSE;
+        }
+
+        BankMask->Calls = max(BankMask->Calls, TotalCalls() - Calls);
+        BankMask->RegisterAccesses = max(BankMask->RegisterAccesses, BenchRegisterAccesses - Accesses);
+
+        //
+        // SimGpioQueryActiveInterrupts marks every enabled pin as asserting
+        // again, as SimGpio has no interrupts of its own, so the status
+        // register depends on how often it was queried. The pins serviced
+        // are compared instead.
+        //
+
+        for (Bank = 0; Bank < SIM_GPIO_TOTAL_BANKS; Bank += 1) {
+            Expected[Bank].StatusRegister = 0;
+            BenchRegisters[Bank].StatusRegister = 0;
+        }
+
+        if (memcmp(Expected, BenchRegisters, sizeof(Expected)) != 0) {
+            return FALSE;
+        }
+    }
+
+    return (BOOLEAN)(BenchFailures == 0);
+}
+
+double
+TimeOperation (
+    _In_ PBENCH_OPERATION_ROUTINE Routine,
+    _In_ ULONG Argument,
+    _In_ ULONG Milliseconds
+    )
+
+/*++
+
+Routine Description:
+
+    Returns the average time of one operation in nanoseconds.
+
+--*/
+
+{
+    LARGE_INTEGER Start;
+    LARGE_INTEGER Now;
+    LONGLONG Budget;
+    ULONGLONG Calls = 0;
+    ULONG i;
+
+    ResetController();
+
+    //
+    // Warm up the caches and the branch predictors.
+    //
+
+    for (i = 0; i < 16; i++) {
+        Routine(&BenchContext, Argument, i * 37);
+    }
+
+    Budget = Frequency.QuadPart * Milliseconds / 1000;
+
+    QueryPerformanceCounter(&Start);
+
+    do {
+        for (i = 0; i < 16; i++) {
+            Routine(&BenchContext, Argument, (ULONG)(Calls + i) * 37);
+        }
+
+        Calls += 16;
+
+        QueryPerformanceCounter(&Now);
+
+    } while (Now.QuadPart - Start.QuadPart < Budget);
+
+    return (double)(Now.QuadPart - Start.QuadPart) * 1e9 / (double)Frequency.QuadPart / (double)Calls;
+}
+
+VOID
+Usage (
+    VOID
+    )
+{
+    printf("Usage: gpioBench [-Milliseconds <n>]\n");
+    printf("    -Milliseconds   time spent on each case (default %d)\n", DEFAULT_MILLISECONDS);
+}
+
+int
+__cdecl
+main (
+    _In_ int argc,
+    _In_reads_(argc) char *argv[]
+    )
+{
+    ULONG Milliseconds = DEFAULT_MILLISECONDS;
+    BENCH_COUNTS PinByPin;
+    BENCH_COUNTS BankMask;
+    double Baseline;
+    double Time;
+    int Argument;
+    int Failures = 0;
+    ULONG o;
+
+    for (Argument = 1; Argument < argc; Argument++) {
+        if ((_stricmp(argv[Argument], "-Milliseconds") == 0) && (Argument + 1 < argc)) {
+            Milliseconds = strtoul(argv[++Argument], NULL, 0);
+
+        } else {
+            Usage();
+            return 1;
+        }
+    }
+
+    if (Milliseconds == 0) {
+        Usage();
+        return 1;
+    }
+
+    QueryPerformanceFrequency(&Frequency);
+
+    //
+    // Keep the timing thread on one processor and ahead of the rest of
+    // the system.
+    //
+
+    SetThreadAffinityMask(GetCurrentThread(), 1);
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+
+    printf("%-18s %-9s %9s %8s %10s %8s\n",
+           "Operation", "Requests", "calls/op", "regs/op", "ns/op", "vs pin");
+
+    for (o = 0; o < ARRAYSIZE(Operations); o++) {
+        BenchFailures = 0;
+        if (!CheckOperation(&Operations[o], &PinByPin, &BankMask)) {
+            printf("%-18s %-9s    MISMATCH against the pin by pin requests\n",
+                   Operations[o].Name, "Bank");
+
+            Failures++;
+            continue;
+        }
+
+        Baseline = TimeOperation(Operations[o].PinByPin, Operations[o].Argument, Milliseconds);
+        printf("%-18s %-9s %9u %8u %10.1f %7.2fx\n",
+               Operations[o].Name,
+               "Pin",
+               PinByPin.Calls,
+               PinByPin.RegisterAccesses,
+               Baseline,
+               1.0);
+
+        Time = TimeOperation(Operations[o].BankMask, Operations[o].Argument, Milliseconds);
+        printf("%-18s %-9s %9u %8u %10.1f %7.2fx\n",
+               Operations[o].Name,
+               "Bank",
+               BankMask.Calls,
+               BankMask.RegisterAccesses,
+               Time,
+               Baseline / Time);
+    }
+
+    if (Failures != 0) {
+        printf("\n%d operation checks failed\n", Failures);
+        return 2;
+    }
+
+    return 0;
+}
@@ -0,0 +1,140 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    gpioBench.h
+
+Abstract:
+
+    The parts of the kernel and GpioClx headers that simgpiobank.c uses,
+    for building it into the user mode benchmark. The register access
+    macros count every access in BenchRegisterAccesses, and the parameter
+    structures only have the fields the SimGpio callbacks use.
+
+    The declarations of the SimGpio callbacks must be kept the same as the
+    GpioClx callback types they implement.
+
+Environment:
+
+    User mode
+
+--*/
+
+#pragma once
+
+#define WIN32_NO_STATUS
+#include <windows.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+
+typedef LONG NTSTATUS;
+
+#define NT_SUCCESS(Status) (((NTSTATUS)(Status)) >= 0)
+
+//
+// Register accesses go to the simulated registers in the benchmark's
+// memory, and are counted.
+//
+
+extern ULONG BenchRegisterAccesses;
+
+#define READ_REGISTER_ULONG(Register) \
+    (BenchRegisterAccesses++, *(volatile ULONG *)(Register))
+
+#define WRITE_REGISTER_ULONG(Register, Value) \
+    (BenchRegisterAccesses++, *(volatile ULONG *)(Register) = (Value))
+
+__inline
+ULONG
+RtlNumberOfSetBitsUlongPtr (
+    _In_ ULONG_PTR Target
+    )
+{
+    ULONG Count = 0;
+
+    while (Target != 0) {
+        Target &= Target - 1;
+        Count += 1;
+    }
+
+    return Count;
+}
+
+//
+// GpioClx parameter structures.
+//
+
+typedef USHORT BANK_ID;
+
+typedef struct _GPIO_READ_PINS_MASK_PARAMETERS {
+    BANK_ID BankId;
+    PULONG64 PinValues;
+    struct {
+        ULONG WriteConfiguredPins : 1;
+    } Flags;
+} GPIO_READ_PINS_MASK_PARAMETERS, *PGPIO_READ_PINS_MASK_PARAMETERS;
+
+typedef struct _GPIO_WRITE_PINS_MASK_PARAMETERS {
+    BANK_ID BankId;
+    ULONG64 SetMask;
+    ULONG64 ClearMask;
+    ULONG Flags;
+} GPIO_WRITE_PINS_MASK_PARAMETERS, *PGPIO_WRITE_PINS_MASK_PARAMETERS;
+
+typedef struct _GPIO_QUERY_ACTIVE_INTERRUPTS_PARAMETERS {
+    BANK_ID BankId;
+    ULONG64 EnabledMask;
+    ULONG64 ActiveMask;
+} GPIO_QUERY_ACTIVE_INTERRUPTS_PARAMETERS, *PGPIO_QUERY_ACTIVE_INTERRUPTS_PARAMETERS;
+
+typedef struct _GPIO_QUERY_ENABLED_INTERRUPTS_PARAMETERS {
+    BANK_ID BankId;
+    ULONG64 EnabledMask;
+} GPIO_QUERY_ENABLED_INTERRUPTS_PARAMETERS, *PGPIO_QUERY_ENABLED_INTERRUPTS_PARAMETERS;
+
+typedef struct _GPIO_CLEAR_ACTIVE_INTERRUPTS_PARAMETERS {
+    BANK_ID BankId;
+    ULONG64 ClearActiveMask;
+    ULONG64 FailedClearMask;
+} GPIO_CLEAR_ACTIVE_INTERRUPTS_PARAMETERS, *PGPIO_CLEAR_ACTIVE_INTERRUPTS_PARAMETERS;
+
+//
+// SimGpio callbacks in simgpiobank.c.
+//
+
+NTSTATUS
+SimGpioQueryActiveInterrupts (
+    _In_ PVOID Context,
+    _In_ PGPIO_QUERY_ACTIVE_INTERRUPTS_PARAMETERS QueryActiveParameters
+    );
+
+NTSTATUS
+SimGpioQueryEnabledInterrupts (
+    _In_ PVOID Context,
+    _In_ PGPIO_QUERY_ENABLED_INTERRUPTS_PARAMETERS QueryEnabledParameters
+    );
+
+NTSTATUS
+SimGpioClearActiveInterrupts (
+    _In_ PVOID Context,
+    _In_ PGPIO_CLEAR_ACTIVE_INTERRUPTS_PARAMETERS ClearParameters
+    );
+
+NTSTATUS
+SimGpioReadGpioPins (
+    _In_ PVOID Context,
+    _In_ PGPIO_READ_PINS_MASK_PARAMETERS ReadParameters
+    );
+
+NTSTATUS
+SimGpioWriteGpioPins (
+    _In_ PVOID Context,
+    _In_ PGPIO_WRITE_PINS_MASK_PARAMETERS WriteParameters
+    );
@@ -0,0 +1,99 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    simgpio.h
+
+Abstract:
+
+    This header defines the SimGpio controller registers and the client
+    driver device extension. It is shared by simgpio.c, simgpiobank.c and
+    the user mode benchmark in the bench directory, which builds
+    simgpiobank.c.
+
+Environment:
+
+    Kernel & user mode
+
+--*/
+
+#pragma once
+
+//
+// -------------------------------------------------------------------- Defines
+//
+
+//
+// Define total number of pins on the simulated GPIO controller.
+//
+
+#define SIM_GPIO_TOTAL_PINS (4 * 32)
+#define SIM_GPIO_PINS_PER_BANK (32)
+#define SIM_GPIO_TOTAL_BANKS (4)
+
+//
+// ---------------------------------------------------------------------- Types
+//
+
+//
+// Define the registers within the SimGPIO controller. There are 32 pins per
+// controller. Note this is a logical device and thus may correspond to a
+// physical bank or module if the GPIO controller in hardware has more than
+// 32 pins.
+//
+
+
+
+typedef struct _SIM_GPIO_REGISTERS {
+    ULONG ModeRegister;
+    ULONG PolarityRegister[2];
+    ULONG EnableRegister;
+    ULONG StatusRegister;
+    ULONG DirectionRegister;
+    ULONG LevelRegister;
+} SIM_GPIO_REGISTERS, *PSIM_GPIO_REGISTERS;
+
+//
+// Define the per-bank call counters. The class extension hands the client
+// driver one bitmask per bank for every read, write, query-active and
+// clear-active operation, regardless of how many pins the request covers.
+// Comparing the call counts against the pin counts below shows how many pin
+// operations each register access serviced. The counters can be inspected
+// from the debugger (dt simgpio!SIM_GPIO_CONTEXT).
+//
+
+typedef struct _SIM_GPIO_BANK_STATISTICS {
+    volatile LONG ReadCalls;
+    volatile LONG WriteCalls;
+    volatile LONG PinsWritten;
+    volatile LONG QueryActiveCalls;
+    volatile LONG InterruptsReported;
+    volatile LONG ClearActiveCalls;
+} SIM_GPIO_BANK_STATISTICS, *PSIM_GPIO_BANK_STATISTICS;
+
+typedef struct _SIM_GPIO_BANK {
+    LARGE_INTEGER PhysicalBaseAddress;
+    PSIM_GPIO_REGISTERS Registers;
+    ULONG Length;
+    SIM_GPIO_REGISTERS SavedContext;
+    SIM_GPIO_BANK_STATISTICS Statistics;
+} SIM_GPIO_BANK, *PSIM_GPIO_BANK;
+
+//
+// The SimGPIO client driver device extension.
+//
+
+typedef struct _SIM_GPIO_CONTEXT {
+    USHORT TotalPins;
+    LARGE_INTEGER PhysicalBaseAddress;
+    PSIM_GPIO_REGISTERS ControllerBase;
+    ULONG Length;
+    SIM_GPIO_BANK Banks[SIM_GPIO_TOTAL_BANKS];
+} SIM_GPIO_CONTEXT, *PSIM_GPIO_CONTEXT;
@@ -0,0 +1,526 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    simgpiobank.c
+
+Abstract:
+
+    This file implements the SimGpio callbacks that GpioClx invokes with a
+    bitmask for a whole bank: querying and clearing active interrupts and
+    reading and writing pins. Each of them costs one or two register
+    accesses, however many pins of the bank the operation covers.
+
+    The file is also built into the user mode benchmark in the bench
+    directory, which counts the callbacks and register accesses per
+    operation; bench\gpioBench.h stands in for the kernel and GpioClx
+    headers there.
+
+Environment:
+
+    Kernel & user mode
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#if defined(_KERNEL_MODE)
+
+#include <ntddk.h>
+#include <wdf.h>
+#include <gpioclx.h>
+
+#else
+
+#include "gpioBench.h"
+
+#endif
+
+#include "simgpio.h"
+
+//
+// ----------------------------------------------------------------- Prototypes
+//
+
+#if defined(_KERNEL_MODE)
+
+GPIO_CLIENT_QUERY_ACTIVE_INTERRUPTS SimGpioQueryActiveInterrupts;
+GPIO_CLIENT_CLEAR_ACTIVE_INTERRUPTS SimGpioClearActiveInterrupts;
+GPIO_CLIENT_QUERY_ENABLED_INTERRUPTS SimGpioQueryEnabledInterrupts;
+GPIO_CLIENT_READ_PINS_MASK SimGpioReadGpioPins;
+GPIO_CLIENT_WRITE_PINS_MASK SimGpioWriteGpioPins;
+
+#endif
+
+//
+// --------------------------------------------------------- Interrupt Handlers
+//
+
+_Must_inspect_result_
+_IRQL_requires_same_
+NTSTATUS
+SimGpioQueryActiveInterrupts (
+    _In_ PVOID Context,
+    _In_ PGPIO_QUERY_ACTIVE_INTERRUPTS_PARAMETERS QueryActiveParameters
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the current set of active interrupts.
+
+Arguments:
+
+    Context - Supplies a pointer to the GPIO client driver's device extension.
+
+    QueryActiveParameters - Supplies a pointer to a structure containing query
+        parameters. Fields are:
+
+        BankId - Supplies the ID for the GPIO bank.
+
+        EnabledMask - Supplies a bitmask of pins enabled for interrupts
+            on the specified GPIO bank.
+
+        ActiveMask - Supplies a bitmask that receives the active interrupt
+            mask. If a pin is interrupting and set in EnabledMask, then the
+            corresponding bit is set in the bitmask.
+
+Return Value:
+
+    NTSTATUS code (STATUS_SUCCESS always for memory-mapped GPIO controllers).
+
+Environment:
+
+    Entry IRQL: DIRQL if the GPIO controller is memory-mapped; PASSIVE_LEVEL
+        if the controller is behind some serial-bus.
+
+        N.B. For memory-mapped controllers, this routine is called from within
+             the interrupt context with the interrupt lock acquired by the class
+             extension.
+
+    Synchronization: The GPIO class extension will synchronize this call
+        against other query/clear active and enabled interrupts.
+        Memory-mapped GPIO controllers:
+            Callbacks invoked at PASSIVE_LEVEL IRQL (e.g. interrupt
+            enable/disable/unmask or IO operations) may be active. Those
+            routines should acquire the interrupt lock prior to manipulating
+            any state accessed from within this routine.
+
+        Serial-accessible GPIO controllers:
+            This call is synchronized with all other interrupt and IO callbacks.
+
+--*/
+
+{
+
+    PSIM_GPIO_BANK GpioBank;
+    PSIM_GPIO_CONTEXT GpioContext;
+    ULONG PinValue;
+    PSIM_GPIO_REGISTERS SimGpioRegisters;
+
+    GpioContext = (PSIM_GPIO_CONTEXT)Context;
+    GpioBank = &GpioContext->Banks[QueryActiveParameters->BankId];
+    SimGpioRegisters = GpioBank->Registers;
+
+    //
+    // NOTE: As SimGPIO is not a real hardware device, no interrupt will ever
+    //       fire. Thus the status register value will never change. To pretend
+    //       as if a real interrupt happened, it marks all currently enabled
+    //       interrupts as asserting. Copy the enable interrupt value into
+    //       the status register.
+    //
+    //       This should NOT be done for a real GPIO controller.
+    //
+
+    //
+    // BEGIN: SIMGPIO HACK.
+    //
+
+    PinValue = READ_REGISTER_ULONG(&SimGpioRegisters->EnableRegister);
+    WRITE_REGISTER_ULONG(&SimGpioRegisters->StatusRegister, PinValue);
+
+    //
+    // END: SIMGPIO HACK.
+    //
+
+    //
+    // Return every pin that is asserting on this bank into the ActiveMask
+    // parameter with a single status register read. Pins that are not set in
+    // the EnabledMask are filtered out so the class extension only services
+    // interrupts it has enabled; it then dispatches all of the reported pins
+    // before clearing them with one ClearActiveInterrupts call for the bank.
+    //
+
+    PinValue = READ_REGISTER_ULONG(&SimGpioRegisters->StatusRegister);
+    PinValue &= (ULONG)QueryActiveParameters->EnabledMask;
+    QueryActiveParameters->ActiveMask = (ULONG64)PinValue;
+
+    InterlockedIncrement(&GpioBank->Statistics.QueryActiveCalls);
+    InterlockedExchangeAdd(&GpioBank->Statistics.InterruptsReported,
+                           (LONG)RtlNumberOfSetBitsUlongPtr(PinValue));
+
+    return STATUS_SUCCESS;
+}
+
+_Must_inspect_result_
+_IRQL_requires_same_
+NTSTATUS
+SimGpioQueryEnabledInterrupts (
+    _In_ PVOID Context,
+    _In_ PGPIO_QUERY_ENABLED_INTERRUPTS_PARAMETERS QueryEnabledParameters
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the current set of enabled interrupts.
+
+Arguments:
+
+    Context - Supplies a pointer to the GPIO client driver's device extension.
+
+    QueryEnabledParameters - Supplies a pointer to a structure containing query
+        parameters. Fields are:
+
+        BankId - Supplies the ID for the GPIO bank.
+
+        EnabledMask - Supplies a bitmask that receives the enabled interrupt
+            mask. If a pin is enabled, then the corresponding bit is set in the
+            mask.
+
+Return Value:
+
+    NTSTATUS code (STATUS_SUCCESS always for memory-mapped GPIO controllers).
+
+Environment:
+
+    Entry IRQL: DIRQL if the GPIO controller is memory-mapped; PASSIVE_LEVEL
+        if the controller is behind some serial-bus.
+
+        N.B. For memory-mapped controllers, this routine is called with the
+             interrupt lock acquired by the class extension, but not always
+             from within the interrupt context.
+
+    Synchronization: The GPIO class extension will synchronize this call
+        against other query/clear active and enabled interrupts.
+        Memory-mapped GPIO controllers:
+            Callbacks invoked at PASSIVE_LEVEL IRQL (e.g. interrupt
+            enable/disable/unmask or IO operations) may be active. Those
+            routines should acquire the interrupt lock prior to manipulating
+            any state accessed from within this routine.
+
+        Serial-accessible GPIO controllers:
+            This call is synchronized with all other interrupt and IO callbacks.
+
+--*/
+
+{
+
+    PSIM_GPIO_BANK GpioBank;
+    PSIM_GPIO_CONTEXT GpioContext;
+    ULONG PinValue;
+    PSIM_GPIO_REGISTERS SimGpioRegisters;
+
+    GpioContext = (PSIM_GPIO_CONTEXT)Context;
+    GpioBank = &GpioContext->Banks[QueryEnabledParameters->BankId];
+    SimGpioRegisters = GpioBank->Registers;
+
+    //
+    // Return the current value of the interrupt enable register into the
+    // EnabledMask parameter. It is strongly preferred that the true state of
+    // the hardware is returned, rather than a software-cached variable, since
+    // CLIENT_QueryEnabledInterrupts is used by the class extension to detect
+    // interrupt storms.
+    //
+
+    PinValue = READ_REGISTER_ULONG(&SimGpioRegisters->EnableRegister);
+    QueryEnabledParameters->EnabledMask = (ULONG64)PinValue;
+    return STATUS_SUCCESS;
+}
+
+_Must_inspect_result_
+_IRQL_requires_same_
+NTSTATUS
+SimGpioClearActiveInterrupts (
+    _In_ PVOID Context,
+    _In_ PGPIO_CLEAR_ACTIVE_INTERRUPTS_PARAMETERS ClearParameters
+    )
+
+/*++
+
+Routine Description:
+
+    This routine clears the GPIO controller's active set of interrupts.
+
+Arguments:
+
+    Context - Supplies a pointer to the GPIO client driver's device extension.
+
+    ClearParameters - Supplies a pointer to a structure containing clear
+        operation parameters. Fields are:
+
+        BankId - Supplies the ID for the GPIO bank.
+
+        ClearActiveMask - Supplies a mask of pins which should be marked as
+            inactive. If a pin should be cleared, then the corresponding bit is
+            set in the mask.
+
+        FailedMask - Supplies a bitmask of pins that failed to be cleared. If
+            a pin could not be cleared, the bit should be set in this field.
+
+            N.B. This should only be done if for non memory-mapped controllers.
+                 Memory-mapped controllers are never expected to fail this
+                 operation.
+
+Return Value:
+
+    NTSTATUS code (STATUS_SUCCESS always for memory-mapped GPIO controllers).
+
+Environment:
+
+    Entry IRQL: DIRQL if the GPIO controller is memory-mapped; PASSIVE_LEVEL
+        if the controller is behind some serial-bus.
+
+        N.B. For memory-mapped controllers, this routine is called from within
+             the interrupt context with the interrupt lock acquired by the class
+             extension.
+
+    Synchronization: The GPIO class extension will synchronize this call
+        against other query/clear active and enabled interrupts.
+        Memory-mapped GPIO controllers:
+            Callbacks invoked at PASSIVE_LEVEL IRQL (e.g. interrupt
+            enable/disable/unmask or IO operations) may be active. Those
+            routines should acquire the interrupt lock prior to manipulating
+            any state accessed from within this routine.
+
+        Serial-accessible GPIO controllers:
+            This call is synchronized with all other interrupt and IO callbacks.
+
+--*/
+
+{
+
+    PSIM_GPIO_BANK GpioBank;
+    PSIM_GPIO_CONTEXT GpioContext;
+    ULONG PinValue;
+    PSIM_GPIO_REGISTERS SimGpioRegisters;
+
+    GpioContext = (PSIM_GPIO_CONTEXT)Context;
+    GpioBank = &GpioContext->Banks[ClearParameters->BankId];
+    SimGpioRegisters = GpioBank->Registers;
+
+    //
+    // Clear the bits that are set in the ClearActiveMask parameter.
+    //
+
+    PinValue = READ_REGISTER_ULONG(&SimGpioRegisters->StatusRegister);
+    PinValue &= ~((ULONG)ClearParameters->ClearActiveMask);
+    WRITE_REGISTER_ULONG(&SimGpioRegisters->StatusRegister, PinValue);
+    InterlockedIncrement(&GpioBank->Statistics.ClearActiveCalls);
+
+    //
+    // Set the bitmask of pins that could not be successfully cleared.
+    // Since this is a memory-mapped controller, the clear operation always
+    // succeeds.
+    //
+
+    ClearParameters->FailedClearMask = 0x0;
+    return STATUS_SUCCESS;
+}
+
+//
+// --------------------------------------------------------------- I/O Handlers
+//
+
+_Must_inspect_result_
+NTSTATUS
+SimGpioReadGpioPins (
+    _In_ PVOID Context,
+    _In_ PGPIO_READ_PINS_MASK_PARAMETERS ReadParameters
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads the current values for all the pins.
+
+    As the FormatIoRequestsAsMasks bit was set inside
+    SimGpioQueryControllerInformation(), all this routine needs to do is read
+    the level register value and return to the GPIO class extension. It will
+    return the right set of bits to the caller.
+
+    N.B. This routine is called at DIRQL for memory-mapped GPIOs and thus not
+         marked as PAGED.
+
+Arguments:
+
+    Context - Supplies a pointer to the GPIO client driver's device extension.
+
+    ReadParameters - Supplies a pointer to a structure containing read
+        operation parameters. Fields are:
+
+        BankId - Supplies the ID for the GPIO bank.
+
+        PinValues - Supplies a pointer to a variable that receives the current
+            pin values.
+
+        Flags - Supplies the flag to be used for read operation. Currently
+            defined flags are:
+
+            WriteConfiguredPins: If set, the read is being done on a set of
+                pin that were configured for write. In such cases, the
+                GPIO client driver is expected to read and return the
+                output register value.
+
+Return Value:
+
+    NTSTATUS code (STATUS_SUCCESS always for memory-mapped GPIO controllers).
+
+Environment:
+
+    Entry IRQL: DIRQL if the GPIO controller is memory-mapped;
+        PASSIVE_LEVEL if the controller is behind some serial-bus.
+
+    Synchronization: The GPIO class extension will synchronize this call
+        against other passive-level interrupt callbacks (e.g. enable/disable)
+        and IO callbacks (connect/disconnect).
+
+--*/
+
+{
+
+    PSIM_GPIO_BANK GpioBank;
+    PSIM_GPIO_CONTEXT GpioContext;
+    ULONG PinValue;
+    PSIM_GPIO_REGISTERS SimGpioRegisters;
+
+    GpioContext = (PSIM_GPIO_CONTEXT)Context;
+    GpioBank = &GpioContext->Banks[ReadParameters->BankId];
+    SimGpioRegisters = GpioBank->Registers;
+
+    //
+    // Read the current level register value. Note the GPIO class may invoke
+    // the read routine on write-configured pins. In such case the output
+    // register values should be read.
+    //
+    // N.B. In case of SimGPIO, the LevelRegister holds the value for input
+    //      as well as output pins. Thus the same register is read in either
+    //      case.
+    //
+
+    if (ReadParameters->Flags.WriteConfiguredPins == FALSE) {
+        PinValue = READ_REGISTER_ULONG(&SimGpioRegisters->LevelRegister);
+
+    } else {
+        PinValue = READ_REGISTER_ULONG(&SimGpioRegisters->LevelRegister);
+    }
+
+    *ReadParameters->PinValues = PinValue;
+    InterlockedIncrement(&GpioBank->Statistics.ReadCalls);
+    return STATUS_SUCCESS;
+}
+
+_Must_inspect_result_
+NTSTATUS
+SimGpioWriteGpioPins (
+    _In_ PVOID Context,
+    _In_ PGPIO_WRITE_PINS_MASK_PARAMETERS WriteParameters
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets the current values for the specified pins. This call is
+    synchronized with the write and connect/disconnect IO calls.
+
+    N.B. This routine is called at DIRQL for memory-mapped GPIOs and thus not
+         marked as PAGED.
+
+Arguments:
+
+    Context - Supplies a pointer to the GPIO client driver's device extension.
+
+    WriteParameters - Supplies a pointer to a structure containing write
+        operation parameters. Fields are:
+
+        BankId - Supplies the ID for the GPIO bank.
+
+        SetMask - Supplies a mask of pins which should be set (0x1). If a pin
+            should be set, then the corresponding bit is set in the mask.
+            All bits that are clear in the mask should be left intact.
+
+        ClearMask - Supplies a mask of pins which should be cleared (0x0). If
+            a pin should be cleared, then the bit is set in the bitmask. All
+            bits that are clear in the mask should be left intact.
+
+        Flags - Supplies the flag controlling the write operation. Currently
+            no flags are defined.
+
+Return Value:
+
+    NTSTATUS code (STATUS_SUCCESS always for memory-mapped GPIO controllers).
+
+Environment:
+
+    Entry IRQL: DIRQL if the GPIO controller is memory-mapped;
+        PASSIVE_LEVEL if the controller is behind some serial-bus.
+
+    Synchronization: The GPIO class extension will synchronize this call
+        against other passive-level interrupt callbacks (e.g. enable/disable)
+        and IO callbacks (connect/disconnect).
+
+--*/
+
+{
+
+    PSIM_GPIO_BANK GpioBank;
+    PSIM_GPIO_CONTEXT GpioContext;
+    ULONG PinValue;
+    PSIM_GPIO_REGISTERS SimGpioRegisters;
+
+    GpioContext = (PSIM_GPIO_CONTEXT)Context;
+    GpioBank = &GpioContext->Banks[WriteParameters->BankId];
+    SimGpioRegisters = GpioBank->Registers;
+
+    //
+    // Read the current level register value.
+    //
+
+    PinValue = READ_REGISTER_ULONG(&SimGpioRegisters->LevelRegister);
+
+    //
+    // Set the bits specified in the set mask and clear the ones specified
+    // in the clear mask.
+    //
+
+    PinValue |= WriteParameters->SetMask;
+    PinValue &= ~WriteParameters->ClearMask;
+
+    //
+    // Write the updated value to the register. All pins of the request that
+    // reside on this bank are updated by this single register write.
+    //
+
+    WRITE_REGISTER_ULONG(&SimGpioRegisters->LevelRegister, PinValue);
+
+    InterlockedIncrement(&GpioBank->Statistics.WriteCalls);
+    InterlockedExchangeAdd(
+        &GpioBank->Statistics.PinsWritten,
+        (LONG)RtlNumberOfSetBitsUlongPtr((ULONG_PTR)(WriteParameters->SetMask |
+                                                     WriteParameters->ClearMask)));
+
+    return STATUS_SUCCESS;
+}
@@ -660,12 +660,9 @@ CLM_PrintInputReport(
     }
     printf("\n");
 
-    if (FALSE == UnpackReport (pDevice->InputReportBuffer,
-                                pDevice->Caps.InputReportByteLength,
-                                HidP_Input,
-                                pDevice->InputData,
-                                pDevice->InputDataLength,
-                                pDevice->Ppd))
+    if (FALSE == UnpackInputReport (pDevice->InputReportBuffer,
+                                     pDevice->Caps.InputReportByteLength,
+                                     pDevice))
     {
         printf("Failed parsing the report data\n");
     }
@@ -748,11 +745,11 @@ CLM_AsyncRead(
     if (!OpenHidDevice(pDevice->DevicePath, 
                         TRUE,
                         FALSE,
-                        FALSE,
+                        TRUE,
                         FALSE,
                         &asyncDevice))
     {
-        printf("Failed opening the device for synchronous read.\n");
+        printf("Failed opening the device for asynchronous read.\n");
         return;
     }
 
@@ -761,6 +758,8 @@ CLM_AsyncRead(
     readContext.NumberOfReads = numReads;
     readContext.DisplayEvent = NULL;
     readContext.DisplayWindow = NULL;
+    readContext.DisplayPending = 0;
+    readContext.ReportCount = 0;
                         
     readThread = CreateThread(  NULL,
                                 0,
@@ -2162,12 +2161,15 @@ bReadDlgProc(
     static HID_DEVICE           asyncDevice;
     static BOOL                 doAsyncReads;
     static BOOL                 doSyncReads;
+    static PCHAR                displayStrings;
+    static UINT                 displayStringCount;
 
            PHID_DEVICE          pDevice;
            DWORD                threadID;
            INT                  iIndex;
            PHID_DATA            pData;
            UINT                 uLoop;
+           UINT                 uCount;
 
 
     switch(message)
@@ -2182,6 +2184,8 @@ bReadDlgProc(
             iLbCounter = 0;
             readThread = NULL;
             readContext.DisplayEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+            readContext.DisplayPending = 0;
+            InitializeCriticalSection(&readContext.DataLock);
 
             if (NULL == readContext.DisplayEvent)
             {
@@ -2240,6 +2244,21 @@ bReadDlgProc(
                            MB_ICONEXCLAMATION);
             }
 
+            //
+            // Room to format one string per input data element, so that
+            //  the data can be copied out quickly under the data lock and
+            //  added to the list box after the lock is released.
+            //
+
+            displayStringCount = max(syncDevice.InputDataLength, asyncDevice.InputDataLength);
+            displayStrings = (PCHAR) calloc(displayStringCount, sizeof(szTempBuff));
+
+            if (NULL == displayStrings && 0 != displayStringCount)
+            {
+                displayStringCount = 0;
+                EndDialog(hDlg, 0);
+            }
+
             PostMessage(hDlg, WM_READ_DONE, 0, 0);
             break; 
 
@@ -2250,12 +2269,33 @@ bReadDlgProc(
             // 
 
             pDevice = (PHID_DEVICE) lParam;
+
+            //
+            // Let the read thread post again for any report that arrives from
+            //  here on.  A report that arrives before the copy below is shown
+            //  twice, which is better than not at all.
+            //
+
+            InterlockedExchange(&readContext.DisplayPending, 0);
             
             //
-            // Display all the data stored in the Input data field for the device
+            // Format all the data stored in the Input data field for the device
+            //  while the read thread can't change it, then display it.
             //
             
             pData = pDevice -> InputData;
+            uCount = min(pDevice -> InputDataLength, displayStringCount);
+
+            EnterCriticalSection(&readContext.DataLock);
+
+            for (uLoop = 0; uLoop < uCount; uLoop++, pData++)
+            {
+                ReportToString(pData, 
+                               displayStrings + uLoop * sizeof(szTempBuff), 
+                               sizeof(szTempBuff));
+            }
+
+            LeaveCriticalSection(&readContext.DataLock);
 
             SendDlgItemMessage(hDlg,
                                IDC_OUTPUT,
@@ -2274,15 +2314,13 @@ bReadDlgProc(
                                    0);
             }
 
-            for (uLoop = 0; uLoop < pDevice->InputDataLength; uLoop++)
+            for (uLoop = 0; uLoop < uCount; uLoop++)
             {
-                ReportToString(pData, szTempBuff, sizeof(szTempBuff));
-          
                 iIndex = (INT) SendDlgItemMessage(hDlg,
                                                   IDC_OUTPUT,
                                                   LB_ADDSTRING,
                                                   0,
-                                                  (LPARAM) szTempBuff);
+                                                  (LPARAM) (displayStrings + uLoop * sizeof(szTempBuff)));
 
                 SendDlgItemMessage(hDlg,
                                    IDC_OUTPUT,
@@ -2300,11 +2338,27 @@ bReadDlgProc(
                                        0,
                                        0);
                 }
-                pData++;
             }
             SetEvent( readContext.DisplayEvent );
             break;
 
+        case WM_TIMER:
+
+            //
+            // Reports per second meter, shown while the read thread runs
+            //
+
+            if (READ_METER_TIMER_ID == wParam)
+            {
+                StringCbPrintf(szTempBuff,
+                               sizeof(szTempBuff),
+                               "Read Data - %u reports/sec",
+                               (ULONG) ((InterlockedExchange(&readContext.ReportCount, 0) * 1000ULL) / READ_METER_INTERVAL));
+
+                SetWindowText(hDlg, szTempBuff);
+            }
+            break;
+
         case WM_READ_DONE:
             EnableWindow(GetDlgItem(hDlg, IDOK), TRUE);
             EnableWindow(GetDlgItem(hDlg, IDC_READ_SYNCH), doSyncReads);
@@ -2317,6 +2371,8 @@ bReadDlgProc(
             SetWindowText(GetDlgItem(hDlg, IDC_READ_ASYNCH_CONT),
                           "Continuous Asynchronous Read");       
 
+            KillTimer(hDlg, READ_METER_TIMER_ID);
+
             readThread = NULL;
             break;
             
@@ -2356,6 +2412,8 @@ bReadDlgProc(
                         readContext.TerminateThread = FALSE;
                         readContext.NumberOfReads = (IDC_READ_ASYNCH_ONCE == LOWORD(wParam))?1:INFINITE_READS;
                         readContext.DisplayWindow = hDlg;
+                        readContext.DisplayPending = 0;
+                        readContext.ReportCount = 0;
                         
                         readThread = CreateThread(  NULL,
                                                     0,
@@ -2383,6 +2441,8 @@ bReadDlgProc(
 
                             SetWindowText(GetDlgItem(hDlg, LOWORD(wParam)), 
                                           "Stop Asynchronous Read");
+
+                            SetTimer(hDlg, READ_METER_TIMER_ID, READ_METER_INTERVAL, NULL);
                         }
                     }
                     else
@@ -2404,6 +2464,13 @@ bReadDlgProc(
 
                 case IDOK:                
                     CloseHidDevice(&asyncDevice);                    
+                    DeleteCriticalSection(&readContext.DataLock);
+
+                    if (NULL != displayStrings)
+                    {
+                        free(displayStrings);
+                        displayStrings = NULL;
+                    }
                     EndDialog(hDlg,0);
                     break;
             }
@@ -3696,121 +3763,192 @@ AsynchReadThreadProc(
     PREAD_THREAD_CONTEXT    Context
 )
 {
-    HANDLE  completionEvent;
-    BOOL    readStatus;
-    DWORD   waitStatus;
-    ULONG   numReadsDone;
-    
-    //
-    // Create the completion event to send to the the OverlappedRead routine
-    //
+    OVERLAPPED  overlap[READ_THREAD_QUEUE_DEPTH];
+    PCHAR       reportBuffer[READ_THREAD_QUEUE_DEPTH];
+    ULONG       reportLength;
+    ULONG       numReadsIssued;
+    ULONG       numReadsDone;
+    ULONG       numPending;
+    ULONG       next;
+    ULONG       i;
+    DWORD       bytesRead;
+    DWORD       waitStatus;
+    BOOL        readStatus;
 
-    completionEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    ZeroMemory(overlap, sizeof(overlap));
+    ZeroMemory(reportBuffer, sizeof(reportBuffer));
+
+    reportLength = Context -> HidDevice -> Caps.InputReportByteLength;
+    numReadsIssued = 0;
+    numReadsDone = 0;
+    numPending = 0;
+    next = 0;
 
     //
-    // If NULL returned, then we cannot proceed any farther so we just exit the 
-    //  the thread
+    // Each queued read gets its own report buffer and completion event, so
+    //  that the device always has a read to complete into while we are busy
+    //  unpacking the previous report.  If any of these can't be allocated
+    //  we cannot proceed any farther so we just exit the thread.
     //
-    
-    if (NULL == completionEvent) 
+
+    for (i = 0; i < READ_THREAD_QUEUE_DEPTH; i++)
     {
-        goto AsyncRead_End;
+        reportBuffer[i] = (PCHAR) calloc(reportLength, sizeof(CHAR));
+        overlap[i].hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+        if (NULL == reportBuffer[i] || NULL == overlap[i].hEvent)
+        {
+            goto AsyncRead_End;
+        }
     }
 
     //
     // Now we enter the main read loop, which does the following:
-    //  1) Calls ReadOverlapped()
-    //  2) Waits for read completion with a timeout just to check if 
-    //      the main thread wants us to terminate our the read request
-    //  3) If the read fails, we simply break out of the loop
-    //      and exit the thread
-    //  4) If the read succeeds, we call UnpackReport to get the relevant
-    //      info and then post a message to main thread to indicate that
-    //      there is new data to display.
-    //  5) We then block on the display event until the main thread says
-    //      it has properly displayed the new data
-    //  6) Look to repeat this loop if we are doing more than one read
+    //  1) Keeps up to READ_THREAD_QUEUE_DEPTH reads outstanding, but never
+    //      more than the number of reads that were asked for
+    //  2) Waits for the oldest read to complete with a timeout just to 
+    //      check if the main thread wants us to terminate the read request
+    //  3) If a read fails, we simply break out of the loop and exit the 
+    //      thread
+    //  4) If the read succeeds, we call UnpackInputReport to get the 
+    //      relevant info.  If there is a display window and it hasn't yet 
+    //      been told about new data, we post it a message to display the
+    //      data.  We don't wait for it to do so, it picks up the latest
+    //      data whenever it gets to the message.
+    //  5) Look to repeat this loop if we are doing more than one read
     //      and the main thread has yet to want us to terminate
     //
 
-    numReadsDone = 0;
-
-    do 
+    while (!Context -> TerminateThread)
     {
-        //
-        // Call ReadOverlapped() and if the return status is TRUE, the ReadFile
-        //  succeeded so we need to block on completionEvent, otherwise, we just
-        //  exit
-        //
-
-        readStatus = ReadOverlapped( Context -> HidDevice, completionEvent );
-
-    
-        if (!readStatus) 
+        while (numPending < READ_THREAD_QUEUE_DEPTH &&
+               (INFINITE_READS == Context -> NumberOfReads ||
+                numReadsIssued < Context -> NumberOfReads))
         {
-           break;
-        }
+            i = (next + numPending) % READ_THREAD_QUEUE_DEPTH;
 
-        while (!Context -> TerminateThread) 
-        {
-            //
-            // Wait for the completion event to be signaled or a timeout
-            //
-            
-            waitStatus = WaitForSingleObject (completionEvent, READ_THREAD_TIMEOUT );
+            ResetEvent(overlap[i].hEvent);
 
-            //
-            // If completionEvent was signaled, then a read just completed
-            //   so let's leave this loop and process the data
-            //
-            
-            if ( WAIT_OBJECT_0 == waitStatus)
-            { 
+            readStatus = ReadFile(Context -> HidDevice -> HidDevice,
+                                  reportBuffer[i],
+                                  reportLength,
+                                  &bytesRead,
+                                  &overlap[i]);
+
+            if (!readStatus && ERROR_IO_PENDING != GetLastError())
+            {
                 break;
             }
+
+            numPending++;
+            numReadsIssued++;
+        }
+
+        if (0 == numPending)
+        {
+            break;
         }
 
         //
-        // Check the TerminateThread again...If it is not set, then data has
-        //  been read.  In this case, we want to Unpack the report into our
-        //  input info and then send a message to the main thread to display
-        //  the new data.
+        // Wait for the completion event to be signaled or a timeout
         //
-        
-        if (!Context -> TerminateThread) 
+
+        waitStatus = WaitForSingleObject(overlap[next].hEvent, READ_THREAD_TIMEOUT);
+
+        if (WAIT_OBJECT_0 != waitStatus)
         {
-            numReadsDone++;
+            continue;
+        }
 
-            UnpackReport(Context -> HidDevice -> InputReportBuffer,
-                          Context -> HidDevice -> Caps.InputReportByteLength,
-                          HidP_Input,
-                          Context -> HidDevice -> InputData,
-                          Context -> HidDevice -> InputDataLength,
-                          Context -> HidDevice -> Ppd);
-            
-            if (NULL != Context -> DisplayEvent) 
-            { 
+        numPending--;
+
+        readStatus = GetOverlappedResult(Context -> HidDevice -> HidDevice,
+                                         &overlap[next],
+                                         &bytesRead,
+                                         FALSE);
+
+        if (!readStatus)
+        {
+            break;
+        }
+
+        numReadsDone++;
+
+        if (NULL != Context -> DisplayEvent) 
+        { 
+            EnterCriticalSection(&Context -> DataLock);
+
+            UnpackInputReport(reportBuffer[next],
+                              (USHORT) reportLength,
+                              Context -> HidDevice);
+
+            LeaveCriticalSection(&Context -> DataLock);
+
+            InterlockedIncrement(&Context -> ReportCount);
+
+            if (0 == InterlockedCompareExchange(&Context -> DisplayPending, 1, 0))
+            {
                 PostMessage(Context -> DisplayWindow,
                             WM_DISPLAY_READ_DATA,
                             0,
                             (LPARAM) Context -> HidDevice);
-
-                WaitForSingleObject( Context -> DisplayEvent, INFINITE );
-            }
-            else if (NULL == Context -> DisplayWindow)
-            {
-                // Running in console mode
-                printf("Read #%d\n", numReadsDone);
-                CLM_PrintInputReport(Context -> HidDevice);
             }
         }
-    } while ( !Context -> TerminateThread &&
-              (INFINITE_READS == Context -> NumberOfReads || 
-               numReadsDone < Context -> NumberOfReads));
+        else if (NULL == Context -> DisplayWindow)
+        {
+            // Running in console mode
+            memcpy(Context -> HidDevice -> InputReportBuffer,
+                   reportBuffer[next],
+                   reportLength);
+
+            printf("Read #%d\n", numReadsDone);
+            CLM_PrintInputReport(Context -> HidDevice);
+        }
+        else
+        {
+            UnpackInputReport(reportBuffer[next],
+                              (USHORT) reportLength,
+                              Context -> HidDevice);
+        }
+
+        next = (next + 1) % READ_THREAD_QUEUE_DEPTH;
+    }
+
+    //
+    // Cancel anything still queued and wait for it to finish before the
+    //  report buffers go away
+    //
+
+    if (0 != numPending)
+    {
+        CancelIo(Context -> HidDevice -> HidDevice);
+
+        for ( ; numPending > 0; numPending--)
+        {
+            GetOverlappedResult(Context -> HidDevice -> HidDevice,
+                                &overlap[next],
+                                &bytesRead,
+                                TRUE);
 
+            next = (next + 1) % READ_THREAD_QUEUE_DEPTH;
+        }
+    }
 
 AsyncRead_End:
 
+    for (i = 0; i < READ_THREAD_QUEUE_DEPTH; i++)
+    {
+        if (NULL != overlap[i].hEvent)
+        {
+            CloseHandle(overlap[i].hEvent);
+        }
+
+        if (NULL != reportBuffer[i])
+        {
+            free(reportBuffer[i]);
+        }
+    }
+
     PostMessage( Context -> DisplayWindow, WM_READ_DONE, 0, 0);
     ExitThread(0);
     return (0);
@@ -3828,15 +3966,19 @@ SynchReadThreadProc(
         
         numReadsDone ++;
 
-        UnpackReport(Context -> HidDevice -> InputReportBuffer,
-                     Context -> HidDevice -> Caps.InputReportByteLength,
-                     HidP_Input,
-                     Context -> HidDevice -> InputData,
-                     Context -> HidDevice -> InputDataLength,
-                     Context -> HidDevice -> Ppd);
-
         if (NULL != Context -> DisplayEvent) 
         {
+            EnterCriticalSection(&Context -> DataLock);
+
+            UnpackInputReport(Context -> HidDevice -> InputReportBuffer,
+                              Context -> HidDevice -> Caps.InputReportByteLength,
+                              Context -> HidDevice);
+
+            LeaveCriticalSection(&Context -> DataLock);
+
+            InterlockedIncrement(&Context -> ReportCount);
+            InterlockedExchange(&Context -> DisplayPending, 1);
+
             PostMessage(Context -> DisplayWindow,
                         WM_DISPLAY_READ_DATA,
                         0,
@@ -3844,6 +3986,12 @@ SynchReadThreadProc(
 
             WaitForSingleObject( Context -> DisplayEvent, INFINITE );
         }
+        else
+        {
+            UnpackInputReport(Context -> HidDevice -> InputReportBuffer,
+                              Context -> HidDevice -> Caps.InputReportByteLength,
+                              Context -> HidDevice);
+        }
         
         if (INFINITE_READS != Context -> NumberOfReads &&
             numReadsDone == Context -> NumberOfReads)
@@ -30,6 +30,19 @@ Revision History:
 
 #define READ_THREAD_TIMEOUT     1000
 
+//
+// Reads the asynchronous read thread keeps pending, so that the device
+// always has somewhere to put the next report while the thread unpacks
+// the last one.
+//
+#define READ_THREAD_QUEUE_DEPTH 4
+
+//
+// Timer for the reports per second meter of the read dialog
+//
+#define READ_METER_TIMER_ID     1
+#define READ_METER_INTERVAL     1000
+
 #define HCLIENT_ERROR           "HClient Error"
 
 #define INFINITE_READS           ((ULONG)-1)
@@ -44,6 +57,20 @@ typedef struct _READ_THREAD_CONTEXT
     ULONG       NumberOfReads;
     BOOL        TerminateThread;
 
+    //
+    // With a display window, the read thread unpacks reports into InputData
+    //  under DataLock and posts WM_DISPLAY_READ_DATA only when the previous
+    //  one has been picked up (DisplayPending), so reading does not wait for
+    //  the display.
+    //
+    CRITICAL_SECTION DataLock;
+    volatile LONG    DisplayPending;
+
+    //
+    // Reports read since the meter last looked
+    //
+    volatile LONG    ReportCount;
+
 } READ_THREAD_CONTEXT, *PREAD_THREAD_CONTEXT;
 
 
@@ -55,6 +55,27 @@ SetupDiGetFunctionClassDeviceInfo (
 // have a more efficient way of moving the hid data to the read, write, and
 // feature routines.
 //
+//
+// Where a HID_DATA element lives in an input report, worked out once from the
+// preparsed data (see BuildInputReportPlans) so that input reports can be
+// unpacked without calling the HidP_ parsing routines for every element of
+// every report.  Elements whose location could not be worked out, such as
+// button arrays, are unpacked with the HidP_ routines as before.
+//
+typedef struct _HID_DATA_LAYOUT {
+   BOOLEAN     IsValid;     // The fields below describe this element
+   BOOLEAN     IsSigned;    // Value: the logical minimum is negative
+   BOOLEAN     IsScaled;    // Value: the logical and physical ranges are usable
+   UCHAR       Reserved;
+   USHORT      BitOffset;   // First bit, counting the report ID byte
+   USHORT      BitSize;     // Value: bits in the value
+                            // Buttons: one bit per usage, from UsageMin
+   LONG        LogicalMin;
+   LONG        LogicalMax;
+   LONG        PhysicalMin;
+   LONG        PhysicalMax;
+} HID_DATA_LAYOUT, *PHID_DATA_LAYOUT;
+
 typedef struct _HID_DATA {
    BOOLEAN     IsButtonData;
    UCHAR       Reserved;
@@ -64,6 +85,7 @@ typedef struct _HID_DATA {
    ULONG       ReportID;    // ReportID for this given data structure
    BOOLEAN     IsDataSet;   // Variable to track whether a given data structure
                             //  has already been added to a report structure
+   HID_DATA_LAYOUT Layout;  // Input data only
 
    union {
       struct {
@@ -83,6 +105,16 @@ typedef struct _HID_DATA {
    };
 } HID_DATA, *PHID_DATA;
 
+//
+// The InputData elements that are carried in one input report
+//
+typedef struct _HID_REPORT_PLAN {
+   ULONG       DataCount;
+   PULONG      DataIndices; // Indices into InputData
+} HID_REPORT_PLAN, *PHID_REPORT_PLAN;
+
+#define HID_MAX_REPORT_IDS  256
+
 typedef struct _HID_DEVICE {   
     PCHAR                DevicePath;
     HANDLE               HidDevice; // A file handle to the hid device.
@@ -101,6 +133,8 @@ typedef struct _HID_DEVICE {
     ULONG                InputDataLength; // Num elements in this array.
     PHIDP_BUTTON_CAPS    InputButtonCaps;
     PHIDP_VALUE_CAPS     InputValueCaps;
+    PHID_REPORT_PLAN     InputReportPlans; // HID_MAX_REPORT_IDS plans, indexed
+                                           //  by report ID, or NULL
 
     PCHAR                OutputReportBuffer;
     _Field_size_(OutputDataLength) 
@@ -176,6 +210,23 @@ UnpackReport (
    IN       PHIDP_PREPARSED_DATA Ppd
    );
 
+BOOLEAN
+BuildInputReportPlans (
+   IN OUT   PHID_DEVICE          HidDevice
+   );
+
+VOID
+FreeInputReportPlans (
+   IN OUT   PHID_DEVICE          HidDevice
+   );
+
+BOOLEAN
+UnpackInputReport (
+   _In_reads_bytes_(ReportBufferLength)PCHAR ReportBuffer,
+   IN       USHORT               ReportBufferLength,
+   IN OUT   PHID_DEVICE          HidDevice
+   );
+
 BOOLEAN
 PackReport (
    _Out_writes_bytes_(ReportBufferLength)PCHAR ReportBuffer,
@@ -579,6 +579,13 @@ FillDeviceInfo(
         }
     }
 
+    //
+    // Work out where each input element lives in its report.  If this fails
+    // input reports are still unpacked, just with the slower HidP_ routines.
+    //
+
+    BuildInputReportPlans(HidDevice);
+
     //
     // setup Output Data buffers.
     //
@@ -922,6 +929,8 @@ CloseHidDevice (
         HidDevice -> InputReportBuffer = NULL;
     }
 
+    FreeInputReportPlans(HidDevice);
+
     if (NULL != HidDevice -> InputData)
     {
         free(HidDevice -> InputData);
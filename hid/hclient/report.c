@@ -347,6 +347,124 @@ RoutineDescription:
 }
 
 
+static BOOLEAN
+UnpackData (
+   _In_reads_bytes_(ReportBufferLength)PCHAR ReportBuffer,
+   IN       USHORT               ReportBufferLength,
+   IN       HIDP_REPORT_TYPE     ReportType,
+   IN OUT   PHID_DATA            Data,
+   IN       PHIDP_PREPARSED_DATA Ppd
+)
+/*++
+Routine Description:
+   Extract one HID_DATA element from ReportBuffer with the HidP_ routines.
+   The caller has checked that the element belongs to the report.
+--*/
+{
+    ULONG       numUsages; // Number of usages returned from GetUsages.
+    ULONG       Index;
+    ULONG       nextUsage;
+
+    if (Data->IsButtonData) 
+    {
+        numUsages = Data->ButtonData.MaxUsageLength;
+
+        Data->Status = HidP_GetUsages (ReportType,
+                                       Data->UsagePage,
+                                       0, // All collections
+                                       Data->ButtonData.Usages,
+                                       &numUsages,
+                                       Ppd,
+                                       ReportBuffer,
+                                       ReportBufferLength);
+
+        if (HIDP_STATUS_SUCCESS != Data->Status)
+        {
+            return FALSE;
+        }
+        
+        //
+        // Get usages writes the list of usages into the buffer
+        // Data->ButtonData.Usages newUsage is set to the number of usages
+        // written into this array.
+        // A usage cannot not be defined as zero, so we'll mark a zero
+        // following the list of usages to indicate the end of the list of
+        // usages
+        //
+        // NOTE: One anomaly of the GetUsages function is the lack of ability
+        //        to distinguish the data for one ButtonCaps from another
+        //        if two different caps structures have the same UsagePage
+        //        For instance:
+        //          Caps1 has UsagePage 07 and UsageRange of 0x00 - 0x167
+        //          Caps2 has UsagePage 07 and UsageRange of 0xe0 - 0xe7
+        //
+        //        However, calling GetUsages for each of the data structs
+        //          will return the same list of usages.  It is the 
+        //          responsibility of the caller to set in the HID_DEVICE
+        //          structure which usages actually are valid for the
+        //          that structure. 
+        //      
+
+        /*
+        // Search through the usage list and remove those that 
+        //    correspond to usages outside the define ranged for this
+        //    data structure.
+        */
+        
+        for (Index = 0, nextUsage = 0; Index < numUsages; Index++) 
+        {
+            if (Data -> ButtonData.UsageMin <= Data -> ButtonData.Usages[Index] &&
+                    Data -> ButtonData.Usages[Index] <= Data -> ButtonData.UsageMax) 
+            {
+                Data -> ButtonData.Usages[nextUsage++] = Data -> ButtonData.Usages[Index];
+                
+            }
+        }
+
+        if (nextUsage < Data -> ButtonData.MaxUsageLength) 
+        {
+            Data->ButtonData.Usages[nextUsage] = 0;
+        }
+    }
+    else 
+    {
+        Data->Status = HidP_GetUsageValue (
+                                        ReportType,
+                                        Data->UsagePage,
+                                        0,               // All Collections.
+                                        Data->ValueData.Usage,
+                                        &Data->ValueData.Value,
+                                        Ppd,
+                                        ReportBuffer,
+                                        ReportBufferLength);
+
+        if (HIDP_STATUS_SUCCESS != Data->Status)
+        {
+            return FALSE;
+        }
+
+        Data->Status = HidP_GetScaledUsageValue (
+                                               ReportType,
+                                               Data->UsagePage,
+                                               0, // All Collections.
+                                               Data->ValueData.Usage,
+                                               &Data->ValueData.ScaledValue,
+                                               Ppd,
+                                               ReportBuffer,
+                                               ReportBufferLength);
+
+        if (HIDP_STATUS_SUCCESS != Data->Status &&
+            HIDP_STATUS_NULL != Data->Status)
+        {
+            return FALSE;
+        }
+
+    }
+
+    Data -> IsDataSet = TRUE;
+    return TRUE;
+}
+
 BOOLEAN
 UnpackReport (
    _In_reads_bytes_(ReportBufferLength)PCHAR ReportBuffer,
@@ -363,11 +481,8 @@ Routine Description:
    in the Data list from the given report.
 --*/
 {
-    ULONG       numUsages; // Number of usages returned from GetUsages.
     ULONG       i;
     UCHAR       reportID;
-    ULONG       Index;
-    ULONG       nextUsage;
     BOOLEAN     result = FALSE;
 
     reportID = ReportBuffer[0];
@@ -376,109 +491,484 @@ Routine Description:
     {
         if (reportID == Data->ReportID) 
         {
-            if (Data->IsButtonData) 
+            if (!UnpackData (ReportBuffer,
+                             ReportBufferLength,
+                             ReportType,
+                             Data,
+                             Ppd))
             {
-                numUsages = Data->ButtonData.MaxUsageLength;
+                goto Done;
+            }
+        }
+    }
 
-                Data->Status = HidP_GetUsages (ReportType,
-                                               Data->UsagePage,
-                                               0, // All collections
-                                               Data->ButtonData.Usages,
-                                               &numUsages,
-                                               Ppd,
-                                               ReportBuffer,
-                                               ReportBufferLength);
+    result = TRUE;
 
-                if (HIDP_STATUS_SUCCESS != Data->Status)
-                {
-                    goto Done;
-                }
-                
-                //
-                // Get usages writes the list of usages into the buffer
-                // Data->ButtonData.Usages newUsage is set to the number of usages
-                // written into this array.
-                // A usage cannot not be defined as zero, so we'll mark a zero
-                // following the list of usages to indicate the end of the list of
-                // usages
-                //
-                // NOTE: One anomaly of the GetUsages function is the lack of ability
-                //        to distinguish the data for one ButtonCaps from another
-                //        if two different caps structures have the same UsagePage
-                //        For instance:
-                //          Caps1 has UsagePage 07 and UsageRange of 0x00 - 0x167
-                //          Caps2 has UsagePage 07 and UsageRange of 0xe0 - 0xe7
-                //
-                //        However, calling GetUsages for each of the data structs
-                //          will return the same list of usages.  It is the 
-                //          responsibility of the caller to set in the HID_DEVICE
-                //          structure which usages actually are valid for the
-                //          that structure. 
-                //      
-
-                /*
-                // Search through the usage list and remove those that 
-                //    correspond to usages outside the define ranged for this
-                //    data structure.
-                */
-                
-                for (Index = 0, nextUsage = 0; Index < numUsages; Index++) 
-                {
-                    if (Data -> ButtonData.UsageMin <= Data -> ButtonData.Usages[Index] &&
-                            Data -> ButtonData.Usages[Index] <= Data -> ButtonData.UsageMax) 
-                    {
-                        Data -> ButtonData.Usages[nextUsage++] = Data -> ButtonData.Usages[Index];
-                        
-                    }
-                }
+Done:
+    return (result);
+}
+
+static LONG
+FindSetBits (
+   _In_reads_bytes_(ReportBufferLength)PCHAR ReportBuffer,
+   IN       USHORT               ReportBufferLength,
+   OUT      PUSHORT              BitCount
+)
+/*++
+Routine Description:
+   Return the first bit set in ReportBuffer, not counting the report ID byte,
+   and in BitCount the number of bits set.  Returns -1 if no bit is set or
+   the set bits are not contiguous.
+--*/
+{
+    ULONG       bit;
+    LONG        first = -1;
+    ULONG       count = 0;
+
+    for (bit = 8; bit < (ULONG) ReportBufferLength * 8; bit++)
+    {
+        if (ReportBuffer[bit / 8] & (1 << (bit % 8)))
+        {
+            if (-1 == first)
+            {
+                first = (LONG) bit;
+            }
+            else if (bit != (ULONG) first + count)
+            {
+                return -1;
+            }
+            count++;
+        }
+    }
+
+    *BitCount = (USHORT) count;
+    return first;
+}
+
+static VOID
+BuildValueLayout (
+   IN OUT   PHID_DEVICE          HidDevice,
+   IN OUT   PHID_DATA            Data,
+   _Inout_updates_bytes_(ReportBufferLength)PCHAR ReportBuffer,
+   IN       USHORT               ReportBufferLength
+)
+/*++
+Routine Description:
+   Find where a value lives in its report by setting all of its bits in an
+   otherwise empty report.  Values whose usage appears more than once, or
+   that are part of a value array, are left to HidP_GetUsageValue.
+--*/
+{
+    HIDP_VALUE_CAPS valueCaps;
+    USHORT          numCaps = 1;
+    USHORT          bitCount;
+    LONG            bitOffset;
+
+    if (HIDP_STATUS_SUCCESS != HidP_GetSpecificValueCaps (HidP_Input,
+                                                          Data->UsagePage,
+                                                          0, // All collections
+                                                          Data->ValueData.Usage,
+                                                          &valueCaps,
+                                                          &numCaps,
+                                                          HidDevice->Ppd) ||
+        1 != numCaps ||
+        valueCaps.ReportID != Data->ReportID ||
+        valueCaps.BitSize == 0 || valueCaps.BitSize > 32 ||
+        (!valueCaps.IsRange && valueCaps.ReportCount != 1))
+    {
+        return;
+    }
+
+    memset (ReportBuffer, 0, ReportBufferLength);
+    ReportBuffer[0] = (UCHAR) Data->ReportID;
+
+    if (HIDP_STATUS_SUCCESS != HidP_SetUsageValue (HidP_Input,
+                                                   Data->UsagePage,
+                                                   0, // All collections
+                                                   Data->ValueData.Usage,
+                                                   (ULONG) ((1ULL << valueCaps.BitSize) - 1),
+                                                   HidDevice->Ppd,
+                                                   ReportBuffer,
+                                                   ReportBufferLength))
+    {
+        return;
+    }
+
+    bitOffset = FindSetBits (ReportBuffer, ReportBufferLength, &bitCount);
+
+    if (-1 == bitOffset || bitCount != valueCaps.BitSize)
+    {
+        return;
+    }
+
+    Data->Layout.BitOffset = (USHORT) bitOffset;
+    Data->Layout.BitSize = bitCount;
+    Data->Layout.LogicalMin = valueCaps.LogicalMin;
+    Data->Layout.LogicalMax = valueCaps.LogicalMax;
+    Data->Layout.PhysicalMin = valueCaps.PhysicalMin;
+    Data->Layout.PhysicalMax = valueCaps.PhysicalMax;
+    Data->Layout.IsSigned = (valueCaps.LogicalMin < 0);
+    Data->Layout.IsScaled = (valueCaps.LogicalMin < valueCaps.LogicalMax &&
+                             valueCaps.PhysicalMin < valueCaps.PhysicalMax);
+    Data->Layout.IsValid = TRUE;
+}
+
+static VOID
+BuildButtonLayout (
+   IN OUT   PHID_DEVICE          HidDevice,
+   IN OUT   PHID_DATA            Data,
+   _Inout_updates_bytes_(ReportBufferLength)PCHAR ReportBuffer,
+   IN       USHORT               ReportBufferLength
+)
+/*++
+Routine Description:
+   Find where a set of buttons lives in its report by pressing each button
+   in turn in an otherwise empty report.  Only buttons that have one bit
+   each, in usage order, are planned; button arrays, which report the
+   usages of the pressed buttons as indices, are left to HidP_GetUsages.
+--*/
+{
+    USAGE       usage;
+    ULONG       numUsages;
+    USHORT      bitCount;
+    LONG        bitOffset;
+    LONG        firstBit = -1;
+    PHID_DATA   other;
+    ULONG       i;
+
+    //
+    // HidP_GetUsages returns the pressed buttons of every cap on the usage
+    // page, and UnpackData keeps those in this element's usage range. Only
+    // the bits of this element are read here, so leave elements whose usage
+    // range overlaps another one on the same page to HidP_GetUsages.
+    //
+
+    for (i = 0, other = HidDevice->InputData; i < HidDevice->InputDataLength; i++, other++)
+    {
+        if (other != Data &&
+            other->IsButtonData &&
+            other->UsagePage == Data->UsagePage &&
+            other->ButtonData.UsageMin <= Data->ButtonData.UsageMax &&
+            Data->ButtonData.UsageMin <= other->ButtonData.UsageMax)
+        {
+            return;
+        }
+    }
+
+    if (Data->ButtonData.UsageMax - Data->ButtonData.UsageMin >= (ULONG) ReportBufferLength * 8)
+    {
+        return;
+    }
+
+    for (usage = (USAGE) Data->ButtonData.UsageMin; usage <= Data->ButtonData.UsageMax; usage++)
+    {
+        memset (ReportBuffer, 0, ReportBufferLength);
+        ReportBuffer[0] = (UCHAR) Data->ReportID;
+
+        numUsages = 1;
+
+        if (HIDP_STATUS_SUCCESS != HidP_SetUsages (HidP_Input,
+                                                   Data->UsagePage,
+                                                   0, // All collections
+                                                   &usage,
+                                                   &numUsages,
+                                                   HidDevice->Ppd,
+                                                   ReportBuffer,
+                                                   ReportBufferLength))
+        {
+            return;
+        }
+
+        bitOffset = FindSetBits (ReportBuffer, ReportBufferLength, &bitCount);
+
+        if (-1 == bitOffset || 1 != bitCount)
+        {
+            return;
+        }
+
+        if (-1 == firstBit)
+        {
+            firstBit = bitOffset;
+        }
+        else if (bitOffset != firstBit + (LONG) (usage - Data->ButtonData.UsageMin))
+        {
+            return;
+        }
+
+        //
+        // USAGE is 16 bits; stop before it wraps
+        //
+
+        if (usage == (USAGE) -1)
+        {
+            break;
+        }
+    }
+
+    Data->Layout.BitOffset = (USHORT) firstBit;
+    Data->Layout.BitSize = (USHORT) (Data->ButtonData.UsageMax - Data->ButtonData.UsageMin + 1);
+    Data->Layout.IsValid = TRUE;
+}
+
+BOOLEAN
+BuildInputReportPlans (
+   IN OUT   PHID_DEVICE          HidDevice
+)
+/*++
+Routine Description:
+   Build, once per device, the plan UnpackInputReport uses: for every report
+   ID the list of InputData elements in that report, and for every element
+   where it lives in the report.  Returns FALSE if there is no plan, in
+   which case UnpackInputReport falls back to UnpackReport.
+--*/
+{
+    PCHAR            reportBuffer = NULL;
+    PHID_REPORT_PLAN plan;
+    PHID_DATA        data;
+    ULONG            i;
+    BOOLEAN          bRet = FALSE;
+
+    if (0 == HidDevice->Caps.InputReportByteLength || NULL == HidDevice->InputData)
+    {
+        goto Done;
+    }
+
+    HidDevice->InputReportPlans = (PHID_REPORT_PLAN)
+        calloc (HID_MAX_REPORT_IDS, sizeof (HID_REPORT_PLAN));
+
+    reportBuffer = (PCHAR) calloc (HidDevice->Caps.InputReportByteLength, sizeof (CHAR));
+
+    if (NULL == HidDevice->InputReportPlans || NULL == reportBuffer)
+    {
+        goto Done;
+    }
+
+    for (i = 0, data = HidDevice->InputData; i < HidDevice->InputDataLength; i++, data++)
+    {
+        if (data->ReportID >= HID_MAX_REPORT_IDS)
+        {
+            goto Done;
+        }
+        HidDevice->InputReportPlans[data->ReportID].DataCount++;
+
+        if (data->IsButtonData)
+        {
+            BuildButtonLayout (HidDevice, data, reportBuffer, HidDevice->Caps.InputReportByteLength);
+        }
+        else
+        {
+            BuildValueLayout (HidDevice, data, reportBuffer, HidDevice->Caps.InputReportByteLength);
+        }
+    }
+
+    for (i = 0, plan = HidDevice->InputReportPlans; i < HID_MAX_REPORT_IDS; i++, plan++)
+    {
+        if (0 != plan->DataCount)
+        {
+            plan->DataIndices = (PULONG) calloc (plan->DataCount, sizeof (ULONG));
+            if (NULL == plan->DataIndices)
+            {
+                goto Done;
+            }
+            plan->DataCount = 0;
+        }
+    }
+
+    for (i = 0, data = HidDevice->InputData; i < HidDevice->InputDataLength; i++, data++)
+    {
+        plan = &HidDevice->InputReportPlans[data->ReportID];
+        plan->DataIndices[plan->DataCount++] = i;
+    }
+
+    bRet = TRUE;
+
+Done:
+    if (NULL != reportBuffer)
+    {
+        free(reportBuffer);
+    }
+
+    if (!bRet)
+    {
+        FreeInputReportPlans(HidDevice);
+    }
+    return bRet;
+}
+
+VOID
+FreeInputReportPlans (
+   IN OUT   PHID_DEVICE          HidDevice
+)
+{
+    ULONG       i;
 
-                if (nextUsage < Data -> ButtonData.MaxUsageLength) 
+    if (NULL != HidDevice->InputReportPlans)
+    {
+        for (i = 0; i < HID_MAX_REPORT_IDS; i++)
+        {
+            if (NULL != HidDevice->InputReportPlans[i].DataIndices)
+            {
+                free(HidDevice->InputReportPlans[i].DataIndices);
+            }
+        }
+        free(HidDevice->InputReportPlans);
+        HidDevice->InputReportPlans = NULL;
+    }
+}
+
+static ULONG
+ExtractBits (
+   _In_reads_bytes_(ReportBufferLength)PCHAR ReportBuffer,
+   IN       USHORT               ReportBufferLength,
+   IN       USHORT               BitOffset,
+   IN       USHORT               BitSize
+)
+/*++
+Routine Description:
+   Read a little endian field of up to 32 bits; the HID report format
+   stores fields least significant bit first.
+--*/
+{
+    ULONGLONG   bits = 0;
+    ULONG       first = BitOffset / 8;
+    ULONG       last = (BitOffset + BitSize - 1) / 8;
+    ULONG       i;
+
+    if (last >= ReportBufferLength)
+    {
+        return 0;
+    }
+
+    for (i = last + 1; i-- > first; )
+    {
+        bits = (bits << 8) | (UCHAR) ReportBuffer[i];
+    }
+
+    bits >>= BitOffset % 8;
+
+    return (ULONG) (bits & ((1ULL << BitSize) - 1));
+}
+
+BOOLEAN
+UnpackInputReport (
+   _In_reads_bytes_(ReportBufferLength)PCHAR ReportBuffer,
+   IN       USHORT               ReportBufferLength,
+   IN OUT   PHID_DEVICE          HidDevice
+)
+/*++
+Routine Description:
+   Unpack an input report into HidDevice->InputData, like UnpackReport, but
+   visit only the elements of the report's ID and read planned elements
+   straight from their bits.
+--*/
+{
+    PHID_REPORT_PLAN plan;
+    PHID_DATA        data;
+    ULONG            i;
+    ULONG            bit;
+    ULONG            nextUsage;
+    LONG             value;
+
+    if (NULL == HidDevice->InputReportPlans)
+    {
+        return UnpackReport (ReportBuffer,
+                             ReportBufferLength,
+                             HidP_Input,
+                             HidDevice->InputData,
+                             HidDevice->InputDataLength,
+                             HidDevice->Ppd);
+    }
+
+    if (0 == ReportBufferLength)
+    {
+        return FALSE;
+    }
+
+    plan = &HidDevice->InputReportPlans[(UCHAR) ReportBuffer[0]];
+
+    for (i = 0; i < plan->DataCount; i++)
+    {
+        data = &HidDevice->InputData[plan->DataIndices[i]];
+
+        if (!data->Layout.IsValid)
+        {
+            if (!UnpackData (ReportBuffer,
+                             ReportBufferLength,
+                             HidP_Input,
+                             data,
+                             HidDevice->Ppd))
+            {
+                return FALSE;
+            }
+            continue;
+        }
+
+        data->Status = HIDP_STATUS_SUCCESS;
+
+        if (data->IsButtonData)
+        {
+            for (bit = 0, nextUsage = 0;
+                 bit < data->Layout.BitSize && nextUsage < data->ButtonData.MaxUsageLength;
+                 bit++)
+            {
+                if (ExtractBits (ReportBuffer, ReportBufferLength, (USHORT) (data->Layout.BitOffset + bit), 1))
                 {
-                    Data->ButtonData.Usages[nextUsage] = 0;
+                    data->ButtonData.Usages[nextUsage++] = (USAGE) (data->ButtonData.UsageMin + bit);
                 }
             }
-            else 
+
+            if (nextUsage < data->ButtonData.MaxUsageLength)
             {
-                Data->Status = HidP_GetUsageValue (
-                                                ReportType,
-                                                Data->UsagePage,
-                                                0,               // All Collections.
-                                                Data->ValueData.Usage,
-                                                &Data->ValueData.Value,
-                                                Ppd,
-                                                ReportBuffer,
-                                                ReportBufferLength);
-
-                if (HIDP_STATUS_SUCCESS != Data->Status)
+                data->ButtonData.Usages[nextUsage] = 0;
+            }
+        }
+        else
+        {
+            data->ValueData.Value = ExtractBits (ReportBuffer,
+                                                 ReportBufferLength,
+                                                 data->Layout.BitOffset,
+                                                 data->Layout.BitSize);
+
+            //
+            // Scale the way HidP_GetScaledUsageValue does: sign extend the
+            // field if the logical range is signed, report HIDP_STATUS_NULL
+            // for a value outside the logical range, and map the logical
+            // range linearly onto the physical one.
+            //
+
+            if (!data->Layout.IsScaled)
+            {
+                data->Status = HIDP_STATUS_BAD_LOG_PHY_VALUES;
+            }
+            else
+            {
+                value = (LONG) data->ValueData.Value;
+
+                if (data->Layout.IsSigned && data->Layout.BitSize < 32 &&
+                    (data->ValueData.Value & (1UL << (data->Layout.BitSize - 1))))
                 {
-                    goto Done;
+                    value = (LONG) (data->ValueData.Value | ~((1UL << data->Layout.BitSize) - 1));
                 }
 
-                Data->Status = HidP_GetScaledUsageValue (
-                                                       ReportType,
-                                                       Data->UsagePage,
-                                                       0, // All Collections.
-                                                       Data->ValueData.Usage,
-                                                       &Data->ValueData.ScaledValue,
-                                                       Ppd,
-                                                       ReportBuffer,
-                                                       ReportBufferLength);
-
-                if (HIDP_STATUS_SUCCESS != Data->Status &&
-                    HIDP_STATUS_NULL != Data->Status)
+                if (value < data->Layout.LogicalMin || value > data->Layout.LogicalMax)
                 {
-                    goto Done;
+                    data->Status = HIDP_STATUS_NULL;
                 }
-
-            } 
-            Data -> IsDataSet = TRUE;
+                else
+                {
+                    data->ValueData.ScaledValue = (LONG)
+                        (((LONGLONG) value - data->Layout.LogicalMin) *
+                         ((LONGLONG) data->Layout.PhysicalMax - data->Layout.PhysicalMin) /
+                         ((LONGLONG) data->Layout.LogicalMax - data->Layout.LogicalMin) +
+                         data->Layout.PhysicalMin);
+                }
+            }
         }
-    }
 
-    result = TRUE;
+        data->IsDataSet = TRUE;
+    }
 
-Done:
-    return (result);
+    return TRUE;
 }
 
 
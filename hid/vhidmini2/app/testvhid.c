@@ -70,6 +70,11 @@ SetOutputReport(
     HANDLE file
     );
 
+BOOLEAN
+InjectInputReports(
+    _In_ HANDLE file
+    );
+
 BOOLEAN
 CheckIfOurDevice(
     HANDLE file
@@ -182,6 +187,14 @@ main(
             goto cleanup;
         }
 
+        //
+        // Batched input report injection
+        //
+        bSuccess = InjectInputReports(file);
+        if (bSuccess == FALSE) {
+            goto cleanup;
+        }
+
         //
         // Get Strings
         //
@@ -360,6 +373,7 @@ GetFeature(
     )
 {
     PMY_DEVICE_ATTRIBUTES myDevAttributes = NULL;
+    PHIDMINI_INJECT_STATS injectStats = NULL;
     ULONG bufferSize;
     PUCHAR buffer;
     BOOLEAN bSuccess;
@@ -406,6 +420,19 @@ GetFeature(
                myDevAttributes->VendorID,
                myDevAttributes->ProductID,
                myDevAttributes->VersionNumber);
+
+        //
+        // The injected report counters follow the attributes
+        //
+        injectStats = (PHIDMINI_INJECT_STATS) (myDevAttributes + 1);
+
+        printf("Injected input reports: \n"
+               "    Injected: %lu, \n"
+               "    Dropped: %lu, \n"
+               "    Completed: %lu\n",
+               injectStats->Injected,
+               injectStats->Dropped,
+               injectStats->Completed);
     }
 
     free(buffer);
@@ -473,6 +500,71 @@ SetFeature(
     return bSuccess;
 }
 
+BOOLEAN
+InjectInputReports(
+    _In_ HANDLE file
+    )
+{
+    HIDMINI_CONTROL_INFO controlInfo;
+    HIDMINI_INPUT_REPORT report;
+    DWORD bytesRead;
+    ULONG matched = 0;
+    ULONG i;
+    BOOLEAN bSuccess;
+
+    //
+    // Discard any reports hidclass already holds so that the reads below
+    // return the injected batch
+    //
+    HidD_FlushQueue(file);
+
+    ZeroMemory(&controlInfo, sizeof(controlInfo));
+
+    controlInfo.ReportId = CONTROL_COLLECTION_REPORT_ID;
+    controlInfo.ControlCode = HIDMINI_CONTROL_CODE_INJECT_INPUT_REPORTS;
+    controlInfo.u.Inject.Count = HIDMINI_MAX_INJECTED_REPORTS;
+
+    for (i = 0; i < HIDMINI_MAX_INJECTED_REPORTS; i++) {
+        controlInfo.u.Inject.Data[i] = (UCHAR) i;
+    }
+
+    bSuccess = HidD_SetFeature(file,                 // HidDeviceObject,
+                               &controlInfo,         // ReportBuffer,
+                               sizeof(controlInfo)   // ReportBufferLength
+                               );
+    if (!bSuccess)
+    {
+        printf("failed HidD_SetFeature (inject input reports)\n");
+        return FALSE;
+    }
+
+    //
+    // Read the batch back. A periodic report from the driver's timer may
+    // land in between, so count matches instead of failing on the first
+    // unexpected byte.
+    //
+    for (i = 0; i < HIDMINI_MAX_INJECTED_REPORTS; i++) {
+
+        ZeroMemory(&report, sizeof(report));
+        report.ReportId = CONTROL_COLLECTION_REPORT_ID;
+
+        if (!ReadFile(file, &report, sizeof(report), &bytesRead, NULL))
+        {
+            printf("failed ReadFile (injected report %lu)\n", i);
+            return FALSE;
+        }
+
+        if (report.Data == (UCHAR) i) {
+            matched++;
+        }
+    }
+
+    printf("Injected %d input reports, %lu read back in order\n",
+           HIDMINI_MAX_INJECTED_REPORTS, matched);
+
+    return GetFeature(file);
+}
+
 BOOLEAN
 GetInputReport(
     HANDLE file
@@ -142,6 +142,7 @@ Return Value:
 {
     NTSTATUS                status;
     WDF_OBJECT_ATTRIBUTES   deviceAttributes;
+    WDF_OBJECT_ATTRIBUTES   lockAttributes;
     WDFDEVICE               device;
     PDEVICE_CONTEXT         deviceContext;
     PHID_DEVICE_ATTRIBUTES  hidAttributes;
@@ -177,6 +178,20 @@ Return Value:
     hidAttributes->ProductID    = HIDMINI_PID;
     hidAttributes->VersionNumber = HIDMINI_VERSION;
 
+    //
+    // The injected report ring is filled from SetFeature and drained from
+    // the read and timer paths, which may run concurrently
+    //
+    WDF_OBJECT_ATTRIBUTES_INIT(&lockAttributes);
+    lockAttributes.ParentObject = device;
+
+    status = WdfSpinLockCreate(&lockAttributes,
+                               &deviceContext->InjectLock);
+    if( !NT_SUCCESS(status) ) {
+        KdPrint(("WdfSpinLockCreate failed 0x%x\n",status));
+        return status;
+    }
+
     status = QueueCreate(device,
                          &deviceContext->DefaultQueue);
     if( !NT_SUCCESS(status) ) {
@@ -606,6 +621,14 @@ Return Value:
     }
     else {
         *CompleteRequest = FALSE;
+
+        //
+        // If injected reports are waiting, hand one out now rather than
+        // leaving the request for the timer
+        //
+        if (QueueContext->DeviceContext->InjectCount != 0) {
+            CompleteInjectedReports(QueueContext->DeviceContext);
+        }
     }
 
     return status;
@@ -712,7 +735,9 @@ Return Value:
     HID_XFER_PACKET         packet;
     ULONG                   reportSize;
     PMY_DEVICE_ATTRIBUTES   myAttributes;
-    PHID_DEVICE_ATTRIBUTES  hidAttributes = &QueueContext->DeviceContext->HidDeviceAttributes;
+    PHIDMINI_INJECT_STATS   injectStats;
+    PDEVICE_CONTEXT         deviceContext = QueueContext->DeviceContext;
+    PHID_DEVICE_ATTRIBUTES  hidAttributes = &deviceContext->HidDeviceAttributes;
 
     KdPrint(("GetFeature\n"));
 
@@ -766,6 +791,20 @@ Return Value:
     myAttributes->VendorID      = hidAttributes->VendorID;
     myAttributes->VersionNumber = hidAttributes->VersionNumber;
 
+    //
+    // Append the injected report counters if the caller left room for them
+    //
+    if (packet.reportBufferLen >= reportSize + sizeof(HIDMINI_INJECT_STATS)) {
+
+        injectStats = (PHIDMINI_INJECT_STATS)(packet.reportBuffer + reportSize);
+
+        WdfSpinLockAcquire(deviceContext->InjectLock);
+        *injectStats = deviceContext->InjectStats;
+        WdfSpinLockRelease(deviceContext->InjectLock);
+
+        reportSize += sizeof(HIDMINI_INJECT_STATS);
+    }
+
     //
     // Report how many bytes were copied
     //
@@ -853,6 +892,27 @@ Return Value:
         WdfRequestSetInformation(Request, reportSize);
         break;
 
+    case HIDMINI_CONTROL_CODE_INJECT_INPUT_REPORTS:
+        //
+        // Queue the batch of input reports and complete as many pending
+        // read requests with them as hidclass has posted
+        //
+        if (controlInfo->u.Inject.Count > HIDMINI_MAX_INJECTED_REPORTS) {
+            status = STATUS_INVALID_PARAMETER;
+            KdPrint(("SetFeature: too many injected reports %d, max %d\n",
+                                controlInfo->u.Inject.Count, HIDMINI_MAX_INJECTED_REPORTS));
+            break;
+        }
+
+        InjectInputReports(QueueContext->DeviceContext,
+                           controlInfo->u.Inject.Data,
+                           controlInfo->u.Inject.Count);
+
+        CompleteInjectedReports(QueueContext->DeviceContext);
+
+        WdfRequestSetInformation(Request, reportSize);
+        break;
+
     case HIDMINI_CONTROL_CODE_DUMMY1:
         status = STATUS_NOT_IMPLEMENTED;
         KdPrint(("SetFeature: HIDMINI_CONTROL_CODE_DUMMY1\n"));
@@ -1349,6 +1409,14 @@ Return Value:
     queue = (WDFQUEUE)WdfTimerGetParentObject(Timer);
     queueContext = GetManualQueueContext(queue);
 
+    //
+    // Injected reports take precedence over the periodic device data
+    //
+    if (queueContext->DeviceContext->InjectCount != 0) {
+        CompleteInjectedReports(queueContext->DeviceContext);
+        return;
+    }
+
     //
     // see if we have a request in manual queue
     //
@@ -1369,6 +1437,120 @@ Return Value:
     }
 }
 
+VOID
+InjectInputReports(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_reads_(Count)
+          PUCHAR            Data,
+    _In_  ULONG             Count
+    )
+/*++
+Routine Description:
+
+    Appends a batch of input report data to the device's injected report
+    ring. Reports that don't fit are dropped and counted.
+
+Arguments:
+
+    DeviceContext - The device whose ring receives the reports
+
+    Data - Data bytes of the input reports, oldest first
+
+    Count - Number of reports in Data
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    ULONG                   i;
+    ULONG                   tail;
+
+    WdfSpinLockAcquire(DeviceContext->InjectLock);
+
+    for (i = 0; i < Count; i++) {
+
+        if (DeviceContext->InjectCount == INJECT_RING_SIZE) {
+            DeviceContext->InjectStats.Dropped += Count - i;
+            break;
+        }
+
+        tail = (DeviceContext->InjectHead + DeviceContext->InjectCount) % INJECT_RING_SIZE;
+        DeviceContext->InjectRing[tail] = Data[i];
+        DeviceContext->InjectCount++;
+        DeviceContext->InjectStats.Injected++;
+    }
+
+    WdfSpinLockRelease(DeviceContext->InjectLock);
+
+    if (i < Count) {
+        KdPrint(("InjectInputReports: ring full, dropped %d reports\n", Count - i));
+    }
+}
+
+VOID
+CompleteInjectedReports(
+    _In_  PDEVICE_CONTEXT   DeviceContext
+    )
+/*++
+Routine Description:
+
+    Completes read requests waiting in the manual queue with injected
+    reports until either the ring or the queue is empty.
+
+    A request is only taken from the queue while a report is available for
+    it, so a request is never pulled out and then put back. The request is
+    completed after the lock is released.
+
+Arguments:
+
+    DeviceContext - The device whose ring and manual queue are drained
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    NTSTATUS                status;
+    WDFREQUEST              request;
+    HIDMINI_INPUT_REPORT    readReport;
+
+    readReport.ReportId = CONTROL_FEATURE_REPORT_ID;
+
+    for (;;) {
+
+        WdfSpinLockAcquire(DeviceContext->InjectLock);
+
+        if (DeviceContext->InjectCount == 0) {
+            WdfSpinLockRelease(DeviceContext->InjectLock);
+            break;
+        }
+
+        status = WdfIoQueueRetrieveNextRequest(
+                                DeviceContext->ManualQueue,
+                                &request);
+        if (!NT_SUCCESS(status)) {
+            WdfSpinLockRelease(DeviceContext->InjectLock);
+            break;
+        }
+
+        readReport.Data = DeviceContext->InjectRing[DeviceContext->InjectHead];
+        DeviceContext->InjectHead = (DeviceContext->InjectHead + 1) % INJECT_RING_SIZE;
+        DeviceContext->InjectCount--;
+        DeviceContext->InjectStats.Completed++;
+
+        WdfSpinLockRelease(DeviceContext->InjectLock);
+
+        status = RequestCopyFromBuffer(request,
+                            &readReport,
+                            sizeof(readReport));
+
+        WdfRequestComplete(request, status);
+    }
+}
+
 NTSTATUS
 CheckRegistryForDescriptor(
         WDFDEVICE Device
@@ -34,6 +34,12 @@ DRIVER_INITIALIZE                   DriverEntry;
 EVT_WDF_DRIVER_DEVICE_ADD           EvtDeviceAdd;
 EVT_WDF_TIMER                       EvtTimerFunc;
 
+//
+// Number of injected input reports the driver can hold until HIDClass
+// posts read requests for them
+//
+#define INJECT_RING_SIZE            256
+
 typedef struct _DEVICE_CONTEXT
 {
     WDFDEVICE               Device;
@@ -45,6 +51,15 @@ typedef struct _DEVICE_CONTEXT
     PHID_REPORT_DESCRIPTOR  ReportDescriptor;
     BOOLEAN                 ReadReportDescFromRegistry;
 
+    //
+    // Ring of injected input report data, protected by InjectLock
+    //
+    WDFSPINLOCK             InjectLock;
+    ULONG                   InjectHead;
+    ULONG                   InjectCount;
+    HIDMINI_INJECT_STATS    InjectStats;
+    UCHAR                   InjectRing[INJECT_RING_SIZE];
+
 } DEVICE_CONTEXT, *PDEVICE_CONTEXT;
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(DEVICE_CONTEXT, GetDeviceContext);
@@ -124,6 +139,19 @@ GetString(
     _In_  WDFREQUEST        Request
     );
 
+VOID
+InjectInputReports(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_reads_(Count)
+          PUCHAR            Data,
+    _In_  ULONG             Count
+    );
+
+VOID
+CompleteInjectedReports(
+    _In_  PDEVICE_CONTEXT   DeviceContext
+    );
+
 NTSTATUS
 GetIndexedString(
     _In_  WDFREQUEST        Request
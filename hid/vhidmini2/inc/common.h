@@ -29,6 +29,13 @@ Environment:
 #define  HIDMINI_CONTROL_CODE_SET_ATTRIBUTES              0x00
 #define  HIDMINI_CONTROL_CODE_DUMMY1                      0x01
 #define  HIDMINI_CONTROL_CODE_DUMMY2                      0x02
+#define  HIDMINI_CONTROL_CODE_INJECT_INPUT_REPORTS        0x03
+
+//
+// Maximum number of input reports that can be queued by one
+// HIDMINI_CONTROL_CODE_INJECT_INPUT_REPORTS request
+//
+#define  HIDMINI_MAX_INJECTED_REPORTS                     32
 
 //
 // This is the report id of the collection to which the control codes are sent
@@ -75,10 +82,41 @@ typedef struct _HIDMINI_CONTROL_INFO {
             ULONG Dummy1;
             ULONG Dummy2;
         } Dummy;
+
+        //
+        // Data bytes of the input reports to queue, oldest first
+        //
+        struct {
+            UCHAR Count;
+            UCHAR Data[HIDMINI_MAX_INJECTED_REPORTS];
+        } Inject;
     } u;
     
 } HIDMINI_CONTROL_INFO, * PHIDMINI_CONTROL_INFO;
 
+//
+// Injected input report counters. These follow MY_DEVICE_ATTRIBUTES in the
+// feature report returned for the control collection.
+//
+typedef struct _HIDMINI_INJECT_STATS {
+
+    //
+    // Reports accepted into the driver's report ring
+    //
+    ULONG   Injected;
+
+    //
+    // Reports discarded because the ring was full
+    //
+    ULONG   Dropped;
+
+    //
+    // Reports used to complete IOCTL_HID_READ_REPORT requests
+    //
+    ULONG   Completed;
+
+} HIDMINI_INJECT_STATS, *PHIDMINI_INJECT_STATS;
+
 //
 // input from device to system
 //
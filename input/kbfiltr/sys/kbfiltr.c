@@ -140,6 +140,7 @@ Return Value:
 --*/
 {
     WDF_OBJECT_ATTRIBUTES   deviceAttributes;
+    WDF_OBJECT_ATTRIBUTES   lockAttributes;
     NTSTATUS                status;
     WDFDEVICE               hDevice;
     WDFQUEUE                hQueue;
@@ -176,6 +177,22 @@ Return Value:
 
     filterExt = FilterGetData(hDevice);
 
+    //
+    // Start with an identity remap table. The application replaces it through
+    // the rawPDO.
+    //
+    WDF_OBJECT_ATTRIBUTES_INIT(&lockAttributes);
+    lockAttributes.ParentObject = hDevice;
+
+    status = WdfSpinLockCreate(&lockAttributes, &filterExt->RemapLock);
+    if (!NT_SUCCESS(status)) {
+        DebugPrint(("WdfSpinLockCreate failed 0x%x\n", status));
+        return status;
+    }
+
+    KbFilter_InitRemapTable(&filterExt->RemapTable);
+    filterExt->RemapActive = FALSE;
+
     //
     // Configure the default queue to be Parallel. Do not use sequential queue
     // if this driver is going to be filtering PS2 ports because it can lead to
@@ -280,9 +297,9 @@ Return Value:
     WDFDEVICE hDevice;
     WDFMEMORY outputMemory;
     PDEVICE_EXTENSION devExt;
+    PKBFILTR_REMAP_TABLE remapTable;
     size_t bytesTransferred = 0;
-
-    UNREFERENCED_PARAMETER(InputBufferLength);
+    size_t length;
 
     DebugPrint(("Entered KbFilter_EvtIoInternalDeviceControl\n"));
 
@@ -324,6 +341,31 @@ Return Value:
         bytesTransferred = sizeof(KEYBOARD_ATTRIBUTES);
         
         break;    
+
+    case IOCTL_KBFILTR_SET_REMAP_TABLE:
+
+        //
+        // Buffer is too small, fail the request
+        //
+        if (InputBufferLength < sizeof(KBFILTR_REMAP_TABLE)) {
+            status = STATUS_BUFFER_TOO_SMALL;
+            break;
+        }
+
+        status = WdfRequestRetrieveInputBuffer(Request,
+                                    sizeof(KBFILTR_REMAP_TABLE),
+                                    &remapTable,
+                                    &length);
+
+        if (!NT_SUCCESS(status)) {
+            DebugPrint(("WdfRequestRetrieveInputBuffer failed %x\n", status));
+            break;
+        }
+
+        status = KbFilter_SetRemapTable(devExt, remapTable);
+
+        break;
+
     default:
         status = STATUS_NOT_IMPLEMENTED;
         break;
@@ -806,6 +848,13 @@ Return Value:
 
     devExt = FilterGetData(hDevice);
 
+    //
+    // Remap the whole batch in place before handing it up
+    //
+    if (devExt->RemapActive) {
+        KbFilter_RemapPackets(devExt, InputDataStart, InputDataEnd);
+    }
+
     (*(PSERVICE_CALLBACK_ROUTINE)(ULONG_PTR) devExt->UpperConnectData.ClassService)(
         devExt->UpperConnectData.ClassDeviceObject,
         InputDataStart,
@@ -813,6 +862,139 @@ Return Value:
         InputDataConsumed);
 }
 
+VOID
+KbFilter_InitRemapTable(
+    OUT PKBFILTR_REMAP_TABLE RemapTable
+    )
+/*++
+
+Routine Description:
+
+    Fills a remap table with the identity mapping.
+
+Arguments:
+
+    RemapTable - Table to fill
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    USHORT i;
+
+    for (i = 0; i < KBFILTR_REMAP_TABLE_SIZE; i++) {
+        RemapTable->MakeCode[i] = i;
+    }
+}
+
+NTSTATUS
+KbFilter_SetRemapTable(
+    IN PDEVICE_EXTENSION DevExt,
+    IN PKBFILTR_REMAP_TABLE RemapTable
+    )
+/*++
+
+Routine Description:
+
+    Validates a remap table sent by the application and makes it the table
+    used by KbFilter_ServiceCallback. The copy is made under RemapLock so a
+    batch of packets is remapped with either the old or the new table, never
+    a mix of both.
+
+Arguments:
+
+    DevExt - Device extension of the filter
+
+    RemapTable - New table, from the request's input buffer
+
+Return Value:
+
+    STATUS_SUCCESS, or STATUS_INVALID_PARAMETER if an entry is out of range
+
+--*/
+{
+    BOOLEAN identity = TRUE;
+    USHORT  i;
+
+    for (i = 0; i < KBFILTR_REMAP_TABLE_SIZE; i++) {
+
+        if (RemapTable->MakeCode[i] >= KBFILTR_REMAP_TABLE_SIZE) {
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        if (RemapTable->MakeCode[i] != i) {
+            identity = FALSE;
+        }
+    }
+
+    WdfSpinLockAcquire(DevExt->RemapLock);
+
+    RtlCopyMemory(&DevExt->RemapTable, RemapTable, sizeof(KBFILTR_REMAP_TABLE));
+    DevExt->RemapActive = !identity;
+
+    WdfSpinLockRelease(DevExt->RemapLock);
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+KbFilter_RemapPackets(
+    IN PDEVICE_EXTENSION DevExt,
+    IN OUT PKEYBOARD_INPUT_DATA InputDataStart,
+    IN PKEYBOARD_INPUT_DATA InputDataEnd
+    )
+/*++
+
+Routine Description:
+
+    Translates the make code of every packet in the batch through the remap
+    table. The lock is taken once for the batch, and each packet costs one
+    table lookup with no per-key branching. E1-prefixed sequences and make
+    codes outside the table are passed through unchanged.
+
+Arguments:
+
+    DevExt - Device extension of the filter
+
+    InputDataStart - First packet of the batch
+
+    InputDataEnd - One past the last packet of the batch
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    PKEYBOARD_INPUT_DATA    packet;
+    PUSHORT                 table;
+    USHORT                  index;
+    USHORT                  code;
+
+    WdfSpinLockAcquire(DevExt->RemapLock);
+
+    table = DevExt->RemapTable.MakeCode;
+
+    for (packet = InputDataStart; packet < InputDataEnd; packet++) {
+
+        if (packet->MakeCode >= KBFILTR_REMAP_E0 || (packet->Flags & KEY_E1)) {
+            continue;
+        }
+
+        index = (USHORT) (packet->MakeCode |
+                          ((packet->Flags & KEY_E0) ? KBFILTR_REMAP_E0 : 0));
+        code = table[index];
+
+        packet->MakeCode = (USHORT) (code & (KBFILTR_REMAP_E0 - 1));
+        packet->Flags = (USHORT) ((packet->Flags & ~KEY_E0) |
+                                  ((code & KBFILTR_REMAP_E0) ? KEY_E0 : 0));
+    }
+
+    WdfSpinLockRelease(DevExt->RemapLock);
+}
+
 VOID
 KbFilterRequestCompletionRoutine(
     WDFREQUEST                  Request,
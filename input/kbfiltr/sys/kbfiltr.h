@@ -102,6 +102,18 @@ typedef struct _DEVICE_EXTENSION
     //
     KEYBOARD_ATTRIBUTES KeyboardAttributes;
 
+    //
+    // Scan code remap table applied to every batch of packets in
+    // KbFilter_ServiceCallback. RemapLock is held while the table is
+    // replaced and while a batch is remapped, so a batch always sees one
+    // whole table. RemapActive is FALSE while the table is the identity.
+    //
+    WDFSPINLOCK RemapLock;
+
+    BOOLEAN RemapActive;
+
+    KBFILTR_REMAP_TABLE RemapTable;
+
 } DEVICE_EXTENSION, *PDEVICE_EXTENSION;
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(DEVICE_EXTENSION,
@@ -155,6 +167,24 @@ KbFilter_ServiceCallback(
     IN OUT PULONG InputDataConsumed
     );
 
+VOID
+KbFilter_InitRemapTable(
+    OUT PKBFILTR_REMAP_TABLE RemapTable
+    );
+
+NTSTATUS
+KbFilter_SetRemapTable(
+    IN PDEVICE_EXTENSION DevExt,
+    IN PKBFILTR_REMAP_TABLE RemapTable
+    );
+
+VOID
+KbFilter_RemapPackets(
+    IN PDEVICE_EXTENSION DevExt,
+    IN OUT PKEYBOARD_INPUT_DATA InputDataStart,
+    IN PKEYBOARD_INPUT_DATA InputDataEnd
+    );
+
 EVT_WDF_REQUEST_COMPLETION_ROUTINE
 KbFilterRequestCompletionRoutine;
 
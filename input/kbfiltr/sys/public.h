@@ -8,4 +8,23 @@
                                                         METHOD_BUFFERED,    \
                                                         FILE_READ_DATA)
 
+#define IOCTL_KBFILTR_SET_REMAP_TABLE CTL_CODE( FILE_DEVICE_KEYBOARD,   \
+                                                IOCTL_INDEX + 1,    \
+                                                METHOD_BUFFERED,    \
+                                                FILE_WRITE_DATA)
+
+//
+// Scan code remap table passed with IOCTL_KBFILTR_SET_REMAP_TABLE. The table
+// is indexed by make code, plus KBFILTR_REMAP_E0 for E0-prefixed keys, and
+// each entry holds the replacement in the same form.
+//
+#define KBFILTR_REMAP_E0            0x100
+#define KBFILTR_REMAP_TABLE_SIZE    0x200
+
+typedef struct _KBFILTR_REMAP_TABLE {
+
+    USHORT MakeCode[KBFILTR_REMAP_TABLE_SIZE];
+
+} KBFILTR_REMAP_TABLE, *PKBFILTR_REMAP_TABLE;
+
 #endif
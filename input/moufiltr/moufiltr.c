@@ -21,6 +21,7 @@ Notes:
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text (INIT, DriverEntry)
 #pragma alloc_text (PAGE, MouFilter_EvtDeviceAdd)
+#pragma alloc_text (PAGE, MouFilter_BuildButtonRemap)
 #pragma alloc_text (PAGE, MouFilter_EvtIoInternalDeviceControl)
 #endif
 
@@ -140,6 +141,7 @@ Return Value:
         return status;
     }
 
+    MouFilter_BuildButtonRemap(hDevice, FilterGetData(hDevice));
 
     //
     // Configure the default queue to be Parallel. Do not use sequential queue
@@ -487,9 +489,24 @@ Return Value:
     PDEVICE_EXTENSION   devExt;
     WDFDEVICE   hDevice;
 
+    PMOUSE_INPUT_DATA   packet;
+
     hDevice = WdfWdmDeviceGetWdfDeviceHandle(DeviceObject);
 
     devExt = FilterGetData(hDevice);
+
+    //
+    // Remap the buttons of the whole batch in place, one table lookup per
+    // packet
+    //
+    if (devExt->ButtonRemapActive) {
+        for (packet = InputDataStart; packet < InputDataEnd; packet++) {
+            packet->ButtonFlags = (USHORT)
+                (devExt->ButtonFlagsRemap[packet->ButtonFlags & MOUFILTR_BUTTON_FLAGS_MASK] |
+                 (packet->ButtonFlags & ~MOUFILTR_BUTTON_FLAGS_MASK));
+        }
+    }
+
     //
     // UpperConnectData must be called at DISPATCH
     //
@@ -501,4 +518,98 @@ Return Value:
         );
 } 
 
+VOID
+MouFilter_BuildButtonRemap(
+    IN WDFDEVICE Device,
+    IN PDEVICE_EXTENSION DevExt
+    )
+/*++
+Routine Description:
+
+    Builds the ButtonFlags translation table from the optional "ButtonMap"
+    REG_BINARY value of the device key. Byte i of the value is the button
+    (1 - 5) that button i + 1 is reported as; a missing or malformed value
+    leaves every button mapped to itself.
+
+    The table covers every combination of the ten down/up bits, so the
+    service callback translates a packet with a single lookup.
+
+--*/
+{
+    WDFKEY          hKey;
+    NTSTATUS        status;
+    UCHAR           buttonMap[MOUFILTR_MAX_BUTTONS];
+    ULONG           valueLength = 0;
+    ULONG           valueType = 0;
+    ULONG           flags;
+    ULONG           button;
+    USHORT          remapped;
+    DECLARE_CONST_UNICODE_STRING(valueName, L"ButtonMap");
+
+    PAGED_CODE();
+
+    for (button = 0; button < MOUFILTR_MAX_BUTTONS; button++) {
+        buttonMap[button] = (UCHAR) (button + 1);
+    }
+
+    status = WdfDeviceOpenRegistryKey(Device,
+                                      PLUGPLAY_REGKEY_DEVICE,
+                                      KEY_READ,
+                                      WDF_NO_OBJECT_ATTRIBUTES,
+                                      &hKey);
+    if (NT_SUCCESS(status)) {
+
+        status = WdfRegistryQueryValue(hKey,
+                                       &valueName,
+                                       sizeof(buttonMap),
+                                       buttonMap,
+                                       &valueLength,
+                                       &valueType);
+
+        WdfRegistryClose(hKey);
+
+        if (NT_SUCCESS(status) &&
+            (valueType != REG_BINARY || valueLength != sizeof(buttonMap))) {
+            status = STATUS_INVALID_PARAMETER;
+        }
+
+        for (button = 0; NT_SUCCESS(status) && button < MOUFILTR_MAX_BUTTONS; button++) {
+            if (buttonMap[button] < 1 || buttonMap[button] > MOUFILTR_MAX_BUTTONS) {
+                status = STATUS_INVALID_PARAMETER;
+            }
+        }
+
+        if (!NT_SUCCESS(status)) {
+            DebugPrint(("ButtonMap not used, status 0x%x\n", status));
+
+            for (button = 0; button < MOUFILTR_MAX_BUTTONS; button++) {
+                buttonMap[button] = (UCHAR) (button + 1);
+            }
+        }
+    }
+
+    DevExt->ButtonRemapActive = FALSE;
+
+    for (button = 0; button < MOUFILTR_MAX_BUTTONS; button++) {
+        if (buttonMap[button] != button + 1) {
+            DevExt->ButtonRemapActive = TRUE;
+        }
+    }
+
+    //
+    // Each button owns two adjacent bits (down, up), so moving button i to
+    // button j moves bits 2i and 2i + 1 to bits 2j and 2j + 1
+    //
+    for (flags = 0; flags < MOUFILTR_BUTTON_FLAGS_TABLE_SIZE; flags++) {
+
+        remapped = 0;
+
+        for (button = 0; button < MOUFILTR_MAX_BUTTONS; button++) {
+            remapped |= (USHORT) (((flags >> (2 * button)) & 3) << (2 * (buttonMap[button] - 1)));
+        }
+
+        DevExt->ButtonFlagsRemap[flags] = remapped;
+    }
+}
+
 #pragma warning(pop)
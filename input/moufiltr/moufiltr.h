@@ -33,6 +33,14 @@ Revision History:
 
 
 
+//
+// The five buttons each have a down and an up bit in the low ten bits of
+// MOUSE_INPUT_DATA.ButtonFlags
+//
+#define MOUFILTR_MAX_BUTTONS                5
+#define MOUFILTR_BUTTON_FLAGS_MASK          0x03FF
+#define MOUFILTR_BUTTON_FLAGS_TABLE_SIZE    (MOUFILTR_BUTTON_FLAGS_MASK + 1)
+
 #if DBG
 
 #define TRAP()                      DbgBreakPoint()
@@ -79,6 +87,15 @@ typedef struct _DEVICE_EXTENSION
     //
     CONNECT_DATA UpperConnectData;
 
+    //
+    // Translation of the button down/up bits of MOUSE_INPUT_DATA.ButtonFlags,
+    // built from the "ButtonMap" value of the device key. ButtonRemapActive
+    // is FALSE when every button maps to itself.
+    //
+    BOOLEAN ButtonRemapActive;
+
+    USHORT ButtonFlagsRemap[MOUFILTR_BUTTON_FLAGS_TABLE_SIZE];
+
   
 } DEVICE_EXTENSION, *PDEVICE_EXTENSION;
 
@@ -121,6 +138,12 @@ MouFilter_ServiceCallback(
     IN OUT PULONG InputDataConsumed
     );
 
+VOID
+MouFilter_BuildButtonRemap(
+    IN WDFDEVICE Device,
+    IN PDEVICE_EXTENSION DevExt
+    );
+
 #endif  // MOUFILTER_H
 
 
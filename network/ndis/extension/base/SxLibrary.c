@@ -141,6 +141,130 @@ Cleanup:
 }
 
 
+BOOLEAN
+SxLibAddNetBufferListToGroup(
+    _Inout_updates_(MaxGroups) PSX_NBL_GROUP Groups,
+    _In_ ULONG MaxGroups,
+    _Inout_ PULONG NumGroups,
+    _In_ NDIS_SWITCH_PORT_ID PortId,
+    _In_ NDIS_SWITCH_NIC_INDEX NicIndex,
+    _In_ PNET_BUFFER_LIST NetBufferList
+    )
+{
+    ULONG groupIndex;
+    PSX_NBL_GROUP group;
+    
+    //
+    // Extensions only keep a handful of groups, and consecutive NBLs
+    // usually share a destination, so search from the newest group.
+    //
+    for (groupIndex = *NumGroups; groupIndex > 0; --groupIndex)
+    {
+        group = &Groups[groupIndex - 1];
+        
+        if (group->PortId == PortId &&
+            group->NicIndex == NicIndex)
+        {
+            goto AddNbl;
+        }
+    }
+    
+    if (*NumGroups == MaxGroups)
+    {
+        return FALSE;
+    }
+    
+    group = &Groups[*NumGroups];
+    ++(*NumGroups);
+    
+    group->PortId = PortId;
+    group->NicIndex = NicIndex;
+    group->NumNetBufferLists = 0;
+    group->NetBufferLists = NULL;
+    group->NextNetBufferList = &group->NetBufferLists;
+    
+AddNbl:
+    *(group->NextNetBufferList) = NetBufferList;
+    group->NextNetBufferList = &(NetBufferList->Next);
+    ++(group->NumNetBufferLists);
+    
+    return TRUE;
+}
+
+
+VOID
+SxLibGroupNetBufferListsByDestination(
+    _In_ PSX_SWITCH_OBJECT Switch,
+    _In_ PNET_BUFFER_LIST NetBufferLists,
+    _Out_writes_to_(MaxGroups, *NumGroups) PSX_NBL_GROUP Groups,
+    _In_ ULONG MaxGroups,
+    _Out_ PULONG NumGroups,
+    _Out_ PNET_BUFFER_LIST *Ungrouped
+    )
+{
+    PNET_BUFFER_LIST curNbl, nextNbl;
+    PNET_BUFFER_LIST *nextUngrouped = Ungrouped;
+    PNDIS_SWITCH_FORWARDING_DESTINATION_ARRAY destinations;
+    PNDIS_SWITCH_PORT_DESTINATION destination;
+    NDIS_STATUS status;
+    
+    *NumGroups = 0;
+    *Ungrouped = NULL;
+    
+    for (curNbl = NetBufferLists; curNbl != NULL; curNbl = nextNbl)
+    {
+        nextNbl = curNbl->Next;
+        curNbl->Next = NULL;
+        
+        status = Switch->NdisSwitchHandlers.GetNetBufferListDestinations(
+                                                Switch->NdisSwitchContext,
+                                                curNbl,
+                                                &destinations);
+                                                
+        if (status == NDIS_STATUS_SUCCESS &&
+            destinations->NumDestinations == 1)
+        {
+            destination = NDIS_SWITCH_PORT_DESTINATION_AT_ARRAY_INDEX(destinations, 0);
+            
+            if (SxLibAddNetBufferListToGroup(Groups,
+                                             MaxGroups,
+                                             NumGroups,
+                                             destination->PortId,
+                                             destination->NicIndex,
+                                             curNbl))
+            {
+                continue;
+            }
+        }
+        
+        *nextUngrouped = curNbl;
+        nextUngrouped = &(curNbl->Next);
+    }
+}
+
+
+VOID
+SxLibSendNetBufferListGroupsIngress(
+    _In_ PSX_SWITCH_OBJECT Switch,
+    _Inout_updates_(*NumGroups) PSX_NBL_GROUP Groups,
+    _Inout_ PULONG NumGroups,
+    _In_ ULONG SendFlags
+    )
+{
+    ULONG groupIndex;
+    
+    for (groupIndex = 0; groupIndex < *NumGroups; ++groupIndex)
+    {
+        SxLibSendNetBufferListsIngress(Switch,
+                                       Groups[groupIndex].NetBufferLists,
+                                       SendFlags,
+                                       0);
+    }
+    
+    *NumGroups = 0;
+}
+
+
 VOID
 SxLibSendNetBufferListsEgress(
     _In_ PSX_SWITCH_OBJECT Switch,
@@ -172,6 +172,169 @@ SxLibCompletedInjectedNetBufferLists(
     _In_ ULONG NumInjectedNetBufferLists
     );    
 
+
+//
+// SX_NBL_GROUP
+// A chain of NBLs that all have the same single destination, built by
+// SxLibAddNetBufferListToGroup and SxLibGroupNetBufferListsByDestination
+// in storage provided by the caller.
+//
+typedef struct _SX_NBL_GROUP
+{
+    NDIS_SWITCH_PORT_ID     PortId;
+    NDIS_SWITCH_NIC_INDEX   NicIndex;
+    ULONG                   NumNetBufferLists;
+    PNET_BUFFER_LIST        NetBufferLists;
+    PNET_BUFFER_LIST        *NextNetBufferList;
+} SX_NBL_GROUP, *PSX_NBL_GROUP;
+
+
+/*++
+
+SxLibAddNetBufferListToGroup
+  
+Routine Description:
+    This function appends an NBL to the group for the given destination,
+    starting a new group if there is none yet. NBL order is preserved
+    within a group.
+    
+Arguments:
+
+    Groups - the caller's group array
+    
+    MaxGroups - the number of entries in Groups
+    
+    NumGroups - the number of groups in use, updated when a group is
+                started
+    
+    PortId - the destination port of NetBufferList
+    
+    NicIndex - the destination NIC index of NetBufferList
+    
+    NetBufferList - the NBL to append, its Next must be NULL
+    
+Return Value:
+    TRUE if the NBL was added.
+    FALSE if there is no group for the destination and Groups is full.
+   
+--*/
+BOOLEAN
+SxLibAddNetBufferListToGroup(
+    _Inout_updates_(MaxGroups) PSX_NBL_GROUP Groups,
+    _In_ ULONG MaxGroups,
+    _Inout_ PULONG NumGroups,
+    _In_ NDIS_SWITCH_PORT_ID PortId,
+    _In_ NDIS_SWITCH_NIC_INDEX NicIndex,
+    _In_ PNET_BUFFER_LIST NetBufferList
+    );
+
+
+/*++
+
+SxLibGroupNetBufferListsByDestination
+  
+Routine Description:
+    This function splits a chain of NBLs into per destination chains in a
+    single pass, without allocating memory. NBLs that do not have exactly
+    one destination, or whose destination does not fit in Groups, are
+    returned in Ungrouped in their original order.
+    
+    Each group can then be sent with NDIS_SEND_FLAGS_SWITCH_DESTINATION_GROUP,
+    see SxLibSendNetBufferListGroupsIngress.
+    
+Arguments:
+
+    Switch - the Switch context
+    
+    NetBufferLists - the NBLs to group
+    
+    Groups - the caller's group array
+    
+    MaxGroups - the number of entries in Groups
+    
+    NumGroups - receives the number of groups built
+    
+    Ungrouped - receives the NBLs that were not grouped
+    
+Return Value:
+    VOID
+   
+--*/
+VOID
+SxLibGroupNetBufferListsByDestination(
+    _In_ PSX_SWITCH_OBJECT Switch,
+    _In_ PNET_BUFFER_LIST NetBufferLists,
+    _Out_writes_to_(MaxGroups, *NumGroups) PSX_NBL_GROUP Groups,
+    _In_ ULONG MaxGroups,
+    _Out_ PULONG NumGroups,
+    _Out_ PNET_BUFFER_LIST *Ungrouped
+    );
+
+
+/*++
+
+SxLibSendNetBufferListGroupsIngress
+  
+Routine Description:
+    This function forwards each group on ingress with
+    SxLibSendNetBufferListsIngress, and empties the group array.
+    
+Arguments:
+
+    Switch - the Switch context
+    
+    Groups - the groups to send
+    
+    NumGroups - the number of groups in use, set to 0 on return
+    
+    SendFlags - the SendFlags equivalent to NDIS flags for
+                NdisFSendNetBufferLists
+    
+Return Value:
+    VOID
+   
+--*/
+VOID
+SxLibSendNetBufferListGroupsIngress(
+    _In_ PSX_SWITCH_OBJECT Switch,
+    _Inout_updates_(*NumGroups) PSX_NBL_GROUP Groups,
+    _Inout_ PULONG NumGroups,
+    _In_ ULONG SendFlags
+    );
+
+
+/*++
+
+SxLibEqualMacAddress
+  
+Routine Description:
+    This function compares two MAC addresses with one 32-bit and
+    one 16-bit compare instead of a byte by byte memory compare.
+    Neither address needs to be aligned.
+    
+Arguments:
+
+    MacAddress1 - the first MAC address
+    
+    MacAddress2 - the second MAC address
+    
+Return Value:
+    TRUE if the addresses are equal.
+   
+--*/
+FORCEINLINE
+BOOLEAN
+SxLibEqualMacAddress(
+    _In_reads_bytes_(6) const UCHAR *MacAddress1,
+    _In_reads_bytes_(6) const UCHAR *MacAddress2
+    )
+{
+    return (((*(UNALIGNED const ULONG *)MacAddress1 ^
+              *(UNALIGNED const ULONG *)MacAddress2) |
+             (*(UNALIGNED const USHORT *)(MacAddress1 + 4) ^
+              *(UNALIGNED const USHORT *)(MacAddress2 + 4))) == 0);
+}
+
     
 /*++
 
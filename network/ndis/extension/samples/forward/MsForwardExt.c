@@ -322,6 +322,7 @@ Routine Description:
                                    Nic->NicType,
                                    FALSE);
 
+    MsForwardFlushFlowCacheUnsafe(switchContext);
                                       
     NdisReleaseRWLock(switchContext->DispatchLock, &lockState);
     
@@ -383,6 +384,8 @@ Routine Description:
             ASSERT(FALSE);
         }
     }
+    
+    MsForwardFlushFlowCacheUnsafe(switchContext);
     NdisReleaseRWLock(switchContext->DispatchLock, &lockState);
 }
 
@@ -463,6 +466,7 @@ Routine Description:
         }
     }
 
+    MsForwardFlushFlowCacheUnsafe(switchContext);
     NdisReleaseRWLock(switchContext->DispatchLock, &lockState);
 }
 
@@ -510,6 +514,7 @@ Routine Description:
                                 Nic->NicIndex);
     }
 
+    MsForwardFlushFlowCacheUnsafe(switchContext);
     NdisReleaseRWLock(switchContext->DispatchLock, &lockState);
     return;
 }
@@ -721,6 +726,7 @@ Routine Description:
                                              macPolicy,
                                              &SwitchProperty->PropertyInstanceId);
         
+        MsForwardFlushFlowCacheUnsafe(switchContext);
         NdisReleaseRWLock(switchContext->DispatchLock, &lockState);
     }
     
@@ -834,6 +840,7 @@ Routine Description:
     MsForwardDeleteMacPolicyUnsafe(switchContext,
                                    &SwitchProperty->PropertyInstanceId);
     
+    MsForwardFlushFlowCacheUnsafe(switchContext);
     NdisReleaseRWLock(switchContext->DispatchLock, &lockState);
     
 Cleanup:
@@ -1337,6 +1344,8 @@ Routine Description:
     the extension broadcasts the NBL to all ports, except the source.
     If the destination MAC is a VM, the extension sets the VM as the destitation.
     Otherwise the extension sets the External port as the destination.
+    Unicast decisions are cached per flow (source port, source and
+    destination MAC, VLAN), so the NIC list is only searched once per flow.
     
 --*/
 {
@@ -1345,7 +1354,8 @@ Routine Description:
     NDIS_SWITCH_NIC_INDEX sourceIndex = 0, prevDestinationIndex = 0, curDestinationIndex = 0;
     PNDIS_SWITCH_FORWARDING_DETAIL_NET_BUFFER_LIST_INFO fwdDetail;
     PMSFORWARD_NIC_LIST_ENTRY sourceNicEntry = NULL;
-    PMSFORWARD_NIC_LIST_ENTRY destinationNicEntry = NULL;
+    MSFORWARD_FLOW_CACHE_ENTRY flow = {0};
+    NDIS_NET_BUFFER_LIST_8021Q_INFO vlanInfo;
     BOOLEAN sameSource;
     PNET_BUFFER_LIST curNbl = NULL, nextNbl = NULL;
     PNET_BUFFER_LIST sendNbl = NULL, dropNbl = NULL;
@@ -1357,7 +1367,8 @@ Routine Description:
     BOOLEAN dispatch;
     PMDL curMdl;
     PUINT8 curBuffer;
-    BOOLEAN broadcast = FALSE;
+    SX_NBL_GROUP sendGroups[MSFORWARD_MAX_SEND_GROUPS];
+    ULONG numSendGroups = 0;
     NDIS_SWITCH_PORT_DESTINATION newDestination = {0};
     PNDIS_SWITCH_FORWARDING_DESTINATION_ARRAY broadcastArray;
     LOCK_STATE_EX lockState;
@@ -1542,19 +1553,14 @@ Routine Description:
         if (ETH_IS_BROADCAST(curHeader->Destination) ||
             ETH_IS_MULTICAST(curHeader->Destination))
         {
-            if(sendNbl != NULL && !broadcast)
-            {
-                //
-                // Send first nbl list, set destinations of this one, continue to work on next.
-                //
-                SxLibSendNetBufferListsIngress(Switch,
-                                               sendNbl,
-                                               SendFlags,
-                                               0);
-                
-                sendNbl = NULL;
-                nextSendNbl = &sendNbl;
-            }
+            //
+            // Send the unicast groups first, set destinations of this one,
+            // continue to work on next.
+            //
+            SxLibSendNetBufferListGroupsIngress(Switch,
+                                                sendGroups,
+                                                &numSendGroups,
+                                                SendFlags);
             
             if (fwdDetail->NumAvailableDestinations < (switchContext->NumDestinations - 1))
             {
@@ -1622,78 +1628,54 @@ Routine Description:
                                                                         
             *nextSendNbl = curNbl;
             nextSendNbl = &(curNbl->Next);
-            broadcast = TRUE;
             
             continue;
         }
             
 
-        if (RtlEqualMemory(prevMacAddress,
-                           curHeader->Destination,
-                           sizeof(prevMacAddress)))
+        if (SxLibEqualMacAddress(prevMacAddress, curHeader->Destination))
         {
             curDestinationPort = prevDestinationPort;
             curDestinationIndex = prevDestinationIndex;
         }
         else
         {
-            destinationNicEntry = MsForwardFindNicByMacAddressUnsafe(switchContext,
-                                                                     curHeader->Destination);
             //
-            // Not a VM or host, send to external.
-            //                                            
-            if (destinationNicEntry == NULL)
+            // Use the cached decision for this flow, resolving and
+            // caching it on a miss.
+            //
+            vlanInfo.Value = NET_BUFFER_LIST_INFO(curNbl, Ieee8021QNetBufferListInfo);
+            
+            flow.SourcePortId = sourcePort;
+            flow.VlanId = (UINT16)vlanInfo.TagHeader.VlanId;
+            RtlCopyMemory(flow.SourceMac, curHeader->Source, sizeof(flow.SourceMac));
+            RtlCopyMemory(flow.DestinationMac,
+                          curHeader->Destination,
+                          sizeof(flow.DestinationMac));
+            
+            if (!MsForwardLookupFlowUnsafe(switchContext, &flow))
             {
-                //
-                // If no external, or source is external, drop.
-                //
-                if (switchContext->ExternalPortId == 0)
+                MsForwardResolveFlowUnsafe(switchContext, &flow);
+                MsForwardInsertFlowUnsafe(switchContext, &flow);
+            }
+            
+            if (flow.Verdict != MsForwardFlowForward)
+            {
+                switch (flow.Verdict)
                 {
+                case MsForwardFlowDropNoExternal:
                     RtlInitUnicodeString(&filterReason, L"No external NIC");
-                    Switch->NdisSwitchHandlers.ReportFilteredNetBufferLists(
-                                         Switch->NdisSwitchContext,
-                                         &SxExtensionGuid,
-                                         &SxExtensionFriendlyName,
-                                         sourcePort,
-                                         NDIS_SWITCH_REPORT_FILTERED_NBL_FLAGS_IS_INCOMING,
-                                         1,
-                                         curNbl,
-                                         &filterReason);
-                                         
-                    *nextDropNbl = curNbl;
-                    nextDropNbl = &curNbl->Next;
-                    continue;
-                }
-                
-                if (sourcePort == switchContext->ExternalPortId)
-                {
+                    break;
+                    
+                case MsForwardFlowDropDestinationIsSource:
                     RtlInitUnicodeString(&filterReason, L"Destination == Source");
-                    Switch->NdisSwitchHandlers.ReportFilteredNetBufferLists(
-                                         Switch->NdisSwitchContext,
-                                         &SxExtensionGuid,
-                                         &SxExtensionFriendlyName,
-                                         sourcePort,
-                                         NDIS_SWITCH_REPORT_FILTERED_NBL_FLAGS_IS_INCOMING,
-                                         1,
-                                         curNbl,
-                                         &filterReason);
-                                         
-                    *nextDropNbl = curNbl;
-                    nextDropNbl = &curNbl->Next;
-                    continue;
+                    break;
+                    
+                default:
+                    RtlInitUnicodeString(&filterReason, L"Destination is NOT connected.");
+                    break;
                 }
-            
-                curDestinationPort = switchContext->ExternalPortId;
-                curDestinationIndex = switchContext->ExternalNicIndex;
-            }
-            else if (destinationNicEntry->Connected)
-            {
-                curDestinationPort = destinationNicEntry->PortId;
-                curDestinationIndex = destinationNicEntry->NicIndex;
-            }
-            else
-            {
-                RtlInitUnicodeString(&filterReason, L"Destination is NOT connected.");
+                
                 Switch->NdisSwitchHandlers.ReportFilteredNetBufferLists(
                                      Switch->NdisSwitchContext,
                                      &SxExtensionGuid,
@@ -1708,6 +1690,9 @@ Routine Description:
                 nextDropNbl = &curNbl->Next;
                 continue;
             }
+            
+            curDestinationPort = flow.DestinationPortId;
+            curDestinationIndex = flow.DestinationNicIndex;
         }
         
         RtlMoveMemory(prevMacAddress, curHeader->Destination, sizeof(prevMacAddress));
@@ -1723,10 +1708,10 @@ Routine Description:
                                                     &newDestination);
         ASSERT(status == NDIS_STATUS_SUCCESS);
           
-        if(sendNbl != NULL && 
-            (broadcast ||
-              (prevDestinationPort != curDestinationPort ||
-               prevDestinationIndex != curDestinationIndex)))
+        //
+        // Send the broadcast NBLs before any unicast NBL queued after them.
+        //
+        if (sendNbl != NULL)
         {
             SxLibSendNetBufferListsIngress(Switch,
                                            sendNbl,
@@ -1737,15 +1722,35 @@ Routine Description:
             nextSendNbl = &sendNbl;
         }
         
-        *nextSendNbl = curNbl;
-        nextSendNbl = &(curNbl->Next);
+        //
+        // Unicast NBLs are chained per destination, so interleaved flows
+        // are still sent as one chain per destination.
+        //
+        if (!SxLibAddNetBufferListToGroup(sendGroups,
+                                          MSFORWARD_MAX_SEND_GROUPS,
+                                          &numSendGroups,
+                                          curDestinationPort,
+                                          curDestinationIndex,
+                                          curNbl))
+        {
+            SxLibSendNetBufferListGroupsIngress(Switch,
+                                                sendGroups,
+                                                &numSendGroups,
+                                                SendFlags);
+                                                
+            SxLibAddNetBufferListToGroup(sendGroups,
+                                         MSFORWARD_MAX_SEND_GROUPS,
+                                         &numSendGroups,
+                                         curDestinationPort,
+                                         curDestinationIndex,
+                                         curNbl);
+        }
             
         //
         // Done processing this NBL.
         //
         prevDestinationPort = curDestinationPort;
         prevDestinationIndex = curDestinationIndex;
-        broadcast = FALSE;
     }
     
 Cleanup:
@@ -1759,6 +1764,11 @@ Cleanup:
                                        0);
     }
     
+    SxLibSendNetBufferListGroupsIngress(Switch,
+                                        sendGroups,
+                                        &numSendGroups,
+                                        SendFlags);
+    
     if (nativeForwardedNbls != NULL)
     {
         SxLibSendNetBufferListsIngress(Switch,
@@ -2082,9 +2092,7 @@ Routine Description:
                                 MSFORWARD_NIC_LIST_ENTRY,
                                 ListEntry);
                                 
-        if (RtlEqualMemory(MacAddress,
-                           nic->MacAddress,
-                           sizeof(nic->MacAddress)))
+        if (SxLibEqualMacAddress(MacAddress, nic->MacAddress))
         {
             goto Cleanup;
         }
@@ -2126,9 +2134,7 @@ Routine Description:
                                    MSFORWARD_MAC_POLICY_LIST_ENTRY,
                                    ListEntry);
                                 
-        if (RtlEqualMemory(MacAddress,
-                           policy->MacAddress,
-                           sizeof(policy->MacAddress)))
+        if (SxLibEqualMacAddress(MacAddress, policy->MacAddress))
         {
             goto Cleanup;
         }
@@ -2298,6 +2304,208 @@ Routine Description:
     return (MsForwardFindPolicyByMacAddressUnsafe(SwitchContext,
                                                   MacAddress) != NULL);
 }
+
+
+VOID
+MsForwardResolveFlowUnsafe(
+    _In_ PMSFORWARD_CONTEXT SwitchContext,
+    _Inout_ PMSFORWARD_FLOW_CACHE_ENTRY Flow
+    )
+/*++
+  
+Routine Description:
+    Determines where a unicast NBL of the given flow is forwarded
+    to by searching the NIC list for its destination MAC address:
+    to the VM or host NIC that owns it, or otherwise to the
+    external NIC.
+    
+--*/
+{
+    PMSFORWARD_NIC_LIST_ENTRY destinationNicEntry;
+    
+    Flow->DestinationPortId = 0;
+    Flow->DestinationNicIndex = 0;
+    
+    destinationNicEntry = MsForwardFindNicByMacAddressUnsafe(SwitchContext,
+                                                             Flow->DestinationMac);
+    //
+    // Not a VM or host, send to external.
+    //
+    if (destinationNicEntry == NULL)
+    {
+        //
+        // If no external, or source is external, drop.
+        //
+        if (SwitchContext->ExternalPortId == 0)
+        {
+            Flow->Verdict = MsForwardFlowDropNoExternal;
+        }
+        else if (Flow->SourcePortId == SwitchContext->ExternalPortId)
+        {
+            Flow->Verdict = MsForwardFlowDropDestinationIsSource;
+        }
+        else
+        {
+            Flow->Verdict = MsForwardFlowForward;
+            Flow->DestinationPortId = SwitchContext->ExternalPortId;
+            Flow->DestinationNicIndex = SwitchContext->ExternalNicIndex;
+        }
+    }
+    else if (destinationNicEntry->Connected)
+    {
+        Flow->Verdict = MsForwardFlowForward;
+        Flow->DestinationPortId = destinationNicEntry->PortId;
+        Flow->DestinationNicIndex = destinationNicEntry->NicIndex;
+    }
+    else
+    {
+        Flow->Verdict = MsForwardFlowDropNotConnected;
+    }
+}
+
+
+static
+ULONG
+MsForwardHashFlow(
+    _In_ PMSFORWARD_FLOW_CACHE_ENTRY Flow
+    )
+/*++
+  
+Routine Description:
+    Returns the flow cache slot of the given flow key (FNV-1a).
+    
+--*/
+{
+    ULONG hash = 2166136261;
+    ULONG i;
+    
+    for (i = 0; i < MSFORWARD_MAC_LENGTH; ++i)
+    {
+        hash = (hash ^ Flow->DestinationMac[i]) * 16777619;
+        hash = (hash ^ Flow->SourceMac[i]) * 16777619;
+    }
+    
+    hash = (hash ^ Flow->VlanId) * 16777619;
+    hash = (hash ^ Flow->SourcePortId) * 16777619;
+    
+    return hash & (MSFORWARD_FLOW_CACHE_SIZE - 1);
+}
+
+
+BOOLEAN
+MsForwardLookupFlowUnsafe(
+    _In_ PMSFORWARD_CONTEXT SwitchContext,
+    _Inout_ PMSFORWARD_FLOW_CACHE_ENTRY Flow
+    )
+/*++
+  
+Routine Description:
+    Looks up the flow whose key (SourcePortId, SourceMac,
+    DestinationMac and VlanId) is set in Flow. On a hit, the cached
+    verdict and destination are copied into Flow and TRUE is returned.
+    
+    The caller holds DispatchLock for read. An entry that is being
+    written by another processor is treated as a miss.
+    
+--*/
+{
+    PMSFORWARD_FLOW_CACHE_ENTRY entry;
+    MSFORWARD_FLOW_CACHE_ENTRY snapshot;
+    LONG sequence;
+    
+    entry = &SwitchContext->FlowCache[MsForwardHashFlow(Flow)];
+    
+    sequence = entry->Sequence;
+    if ((sequence & 1) != 0)
+    {
+        return FALSE;
+    }
+    
+    KeMemoryBarrier();
+    RtlCopyMemory(&snapshot, entry, sizeof(snapshot));
+    KeMemoryBarrier();
+    
+    if (entry->Sequence != sequence)
+    {
+        return FALSE;
+    }
+    
+    if (!snapshot.Valid ||
+        snapshot.SourcePortId != Flow->SourcePortId ||
+        snapshot.VlanId != Flow->VlanId ||
+        !SxLibEqualMacAddress(snapshot.DestinationMac, Flow->DestinationMac) ||
+        !SxLibEqualMacAddress(snapshot.SourceMac, Flow->SourceMac))
+    {
+        return FALSE;
+    }
+    
+    Flow->Verdict = snapshot.Verdict;
+    Flow->DestinationPortId = snapshot.DestinationPortId;
+    Flow->DestinationNicIndex = snapshot.DestinationNicIndex;
+    
+    return TRUE;
+}
+
+
+VOID
+MsForwardInsertFlowUnsafe(
+    _In_ PMSFORWARD_CONTEXT SwitchContext,
+    _In_ PMSFORWARD_FLOW_CACHE_ENTRY Flow
+    )
+/*++
+  
+Routine Description:
+    Caches the resolved flow, replacing whatever flow occupies its slot.
+    
+    The caller holds DispatchLock for read. If another processor is
+    writing the same slot, the flow is simply not cached.
+    
+--*/
+{
+    PMSFORWARD_FLOW_CACHE_ENTRY entry;
+    LONG sequence;
+    
+    entry = &SwitchContext->FlowCache[MsForwardHashFlow(Flow)];
+    
+    sequence = entry->Sequence;
+    if ((sequence & 1) != 0 ||
+        InterlockedCompareExchange(&entry->Sequence,
+                                   sequence + 1,
+                                   sequence) != sequence)
+    {
+        return;
+    }
+    
+    entry->SourcePortId = Flow->SourcePortId;
+    entry->VlanId = Flow->VlanId;
+    RtlCopyMemory(entry->SourceMac, Flow->SourceMac, sizeof(entry->SourceMac));
+    RtlCopyMemory(entry->DestinationMac,
+                  Flow->DestinationMac,
+                  sizeof(entry->DestinationMac));
+    entry->Verdict = Flow->Verdict;
+    entry->DestinationPortId = Flow->DestinationPortId;
+    entry->DestinationNicIndex = Flow->DestinationNicIndex;
+    entry->Valid = TRUE;
+    
+    InterlockedIncrement(&entry->Sequence);
+}
+
+
+VOID
+MsForwardFlushFlowCacheUnsafe(
+    _In_ PMSFORWARD_CONTEXT SwitchContext
+    )
+/*++
+  
+Routine Description:
+    Invalidates every cached flow. Must be called, with DispatchLock
+    held for write, whenever a NIC is created, connected, disconnected
+    or deleted, or a MAC policy is added or deleted.
+    
+--*/
+{
+    NdisZeroMemory(SwitchContext->FlowCache, sizeof(SwitchContext->FlowCache));
+}
     
 
 VOID
@@ -2393,6 +2601,7 @@ Routine Description:
     PNDIS_SWITCH_PORT_PROPERTY_ENUM_PARAMETERS portPropertyParameters = NULL;
     PNDIS_SWITCH_PORT_PROPERTY_ENUM_INFO portPropertyInfo = NULL;
     PNDIS_SWITCH_PORT_PROPERTY_VLAN vlanProperty;
+    LOCK_STATE_EX lockState;
     
     ASSERT(!SwitchContext->IsActive);
 
@@ -2563,6 +2772,13 @@ Routine Description:
         }
     }
     
+    //
+    // Forget any decisions made before the NIC list was populated.
+    //
+    NdisAcquireRWLockWrite(SwitchContext->DispatchLock, &lockState, 0);
+    MsForwardFlushFlowCacheUnsafe(SwitchContext);
+    NdisReleaseRWLock(SwitchContext->DispatchLock, &lockState);
+    
     SwitchContext->IsActive = TRUE;
 
 Cleanup:
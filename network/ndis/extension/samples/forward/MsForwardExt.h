@@ -17,6 +17,51 @@ Abstract:
 
 #define MSFORWARD_MAC_LENGTH    6
 
+//
+// Number of entries in the per switch flow cache. Must be a power of 2.
+//
+#define MSFORWARD_FLOW_CACHE_SIZE   1024
+
+//
+// Number of unicast destinations the ingress path chains NBLs for
+// before it sends them.
+//
+#define MSFORWARD_MAX_SEND_GROUPS   8
+
+//
+// MSFORWARD_FLOW_VERDICT
+// The cached unicast forwarding decision for a flow.
+//
+typedef enum _MSFORWARD_FLOW_VERDICT
+{
+    MsForwardFlowForward,
+    MsForwardFlowDropNoExternal,
+    MsForwardFlowDropDestinationIsSource,
+    MsForwardFlowDropNotConnected
+} MSFORWARD_FLOW_VERDICT;
+
+//
+// MSFORWARD_FLOW_CACHE_ENTRY
+// A unicast forwarding decision, keyed by source port, source MAC,
+// destination MAC and VLAN.
+// Entries are filled in by the ingress path while it holds DispatchLock
+// for read, so each entry is guarded by a sequence count which is odd
+// while the entry is being written. The whole cache is flushed with
+// DispatchLock held for write whenever a NIC or policy changes.
+//
+typedef struct _MSFORWARD_FLOW_CACHE_ENTRY
+{
+    volatile LONG           Sequence;
+    BOOLEAN                 Valid;
+    UINT16                  VlanId;
+    UINT8                   SourceMac[MSFORWARD_MAC_LENGTH];
+    UINT8                   DestinationMac[MSFORWARD_MAC_LENGTH];
+    NDIS_SWITCH_PORT_ID     SourcePortId;
+    MSFORWARD_FLOW_VERDICT  Verdict;
+    NDIS_SWITCH_PORT_ID     DestinationPortId;
+    NDIS_SWITCH_NIC_INDEX   DestinationNicIndex;
+} MSFORWARD_FLOW_CACHE_ENTRY, *PMSFORWARD_FLOW_CACHE_ENTRY;
+
 //
 // MSFORWARD_CONTEXT
 // The context allocated per switch.
@@ -39,6 +84,12 @@ typedef struct _MSFORWARD_CONTEXT
     
     UINT32                  NumDestinations;
     BOOLEAN                 IsInitialRestart;
+
+    //
+    // Unicast forwarding decisions, so the NIC list is only
+    // searched on the first NBL of a flow.
+    //
+    MSFORWARD_FLOW_CACHE_ENTRY  FlowCache[MSFORWARD_FLOW_CACHE_SIZE];
 } MSFORWARD_CONTEXT, *PMSFORWARD_CONTEXT;
 
 //
@@ -204,6 +255,29 @@ MsForwardNicHasPolicy(
     _In_reads_bytes_(6) PUCHAR MacAddress
     );
     
+VOID
+MsForwardResolveFlowUnsafe(
+    _In_ PMSFORWARD_CONTEXT SwitchContext,
+    _Inout_ PMSFORWARD_FLOW_CACHE_ENTRY Flow
+    );
+
+BOOLEAN
+MsForwardLookupFlowUnsafe(
+    _In_ PMSFORWARD_CONTEXT SwitchContext,
+    _Inout_ PMSFORWARD_FLOW_CACHE_ENTRY Flow
+    );
+
+VOID
+MsForwardInsertFlowUnsafe(
+    _In_ PMSFORWARD_CONTEXT SwitchContext,
+    _In_ PMSFORWARD_FLOW_CACHE_ENTRY Flow
+    );
+
+VOID
+MsForwardFlushFlowCacheUnsafe(
+    _In_ PMSFORWARD_CONTEXT SwitchContext
+    );
+
 VOID
 MsForwardMakeBroadcastArrayUnsafe(
     _In_ PMSFORWARD_CONTEXT SwitchContext,
@@ -0,0 +1,649 @@
+/*++
+
+Copyright (c) Microsoft Corporation
+
+Module Name:
+
+    classifyBench.c
+
+Abstract:
+
+    A benchmark for the packet classification hook of the filter.
+
+    It builds classify.c from the filter directory, so it runs the same
+    chain handling the filter does, and drives it with chains of synthetic
+    NBLs and a classifier that looks each NBL's verdict up in a table.
+    For each chain length and verdict pattern it times
+
+    - filterClassifyChain, which the send path and the pendable receive
+      path use, against taking the NBLs off the chain one at a time,
+      classifying each alone and appending it to a pass or a drop chain;
+
+    - filterIndicateClassified, which the receive path uses for chains it
+      may not pend, against classifying and indicating the NBLs one at a
+      time;
+
+    and checks that each pair passes and drops the same NBLs in the same
+    order, and that the receive chain is intact afterwards.  The times
+    include linking the chain up again before each call, which is the same
+    for both of a pair.
+
+    The stand-ins for the classifier and for NdisFIndicateReceiveNetBufferLists
+    cost next to nothing per call, so by default the numbers are those of
+    the chain handling alone.  A real classifier has a fixed cost per call,
+    and a real indication goes up through the filters and protocols above;
+    -CallCost adds a busy loop of the given number of iterations to every
+    call of either, to show where handing over whole chains pays off.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_code_)
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "classifyBench.h"
+
+#define DEFAULT_MILLISECONDS    200
+#define DEFAULT_CALL_COST       0
+
+#define MAX_CHAIN               1024
+
+typedef
+VOID
+(*PBENCH_CHAIN_ROUTINE)(
+    _In_ PMS_FILTER                 pFilter,
+    _In_ PNET_BUFFER_LIST           NetBufferLists,
+    _Out_ PFILTER_NBL_CHAIN         PassChain,
+    _Out_ PFILTER_NBL_CHAIN         DropChain
+    );
+
+typedef struct _BENCH_ROUTINE
+{
+    PCSTR                           Name;
+    PBENCH_CHAIN_ROUTINE            Routine;
+    BOOLEAN                         Indicates;
+} BENCH_ROUTINE, *PBENCH_ROUTINE;
+
+typedef struct _BENCH_PATTERN
+{
+    PCSTR                           Name;
+    ULONG                           DropEvery;      // 0 drops none, 1 all, n one in n
+    BOOLEAN                         Random;         // drop about half, at random
+} BENCH_PATTERN, *PBENCH_PATTERN;
+
+PNET_BUFFER_LIST    Nbls;
+UCHAR               Verdict[MAX_CHAIN];
+
+ULONG               Indicated[MAX_CHAIN];
+ULONG               IndicatedCount;
+ULONG               IndicateErrors;
+
+ULONG               CallCost = DEFAULT_CALL_COST;
+volatile ULONG      CallCostSink;
+
+LARGE_INTEGER       Frequency;
+
+FILTER_CLASSIFY_CHAIN BenchClassify;
+
+
+VOID
+SpendCallCost(
+    VOID
+    )
+{
+    ULONG   i;
+
+    for (i = 0; i < CallCost; i++)
+    {
+        CallCostSink++;
+    }
+}
+
+
+_Use_decl_annotations_
+ULONG64
+BenchClassify(
+    PVOID                           ClassifyContext,
+    PNET_BUFFER_LIST                NetBufferLists,
+    ULONG                           NumberOfNetBufferLists,
+    BOOLEAN                         Receive
+    )
+/*++
+
+Routine Description:
+
+    The classifier: bit i of the result is the table verdict of the i-th
+    NBL of the chain.
+
+--*/
+{
+    const UCHAR        *Verdicts = ClassifyContext;
+    PNET_BUFFER_LIST    Current;
+    ULONG64             Result = 0;
+    ULONG               i = 0;
+
+    UNREFERENCED_PARAMETER(NumberOfNetBufferLists);
+    UNREFERENCED_PARAMETER(Receive);
+
+    SpendCallCost();
+
+    for (Current = NetBufferLists; Current != NULL; Current = NET_BUFFER_LIST_NEXT_NBL(Current), i++)
+    {
+        Result |= (ULONG64)Verdicts[Current->Index] << i;
+    }
+
+    return Result;
+}
+
+
+_Use_decl_annotations_
+VOID
+NdisFIndicateReceiveNetBufferLists(
+    NDIS_HANDLE                     NdisFilterHandle,
+    PNET_BUFFER_LIST                NetBufferLists,
+    NDIS_PORT_NUMBER                PortNumber,
+    ULONG                           NumberOfNetBufferLists,
+    ULONG                           ReceiveFlags
+    )
+/*++
+
+Routine Description:
+
+    Stands in for NDIS: records the NBLs indicated, and counts a chain
+    whose length is not NumberOfNetBufferLists as an error.
+
+--*/
+{
+    PNET_BUFFER_LIST    Current;
+    ULONG               Count = 0;
+
+    UNREFERENCED_PARAMETER(NdisFilterHandle);
+    UNREFERENCED_PARAMETER(PortNumber);
+    UNREFERENCED_PARAMETER(ReceiveFlags);
+
+    SpendCallCost();
+
+    for (Current = NetBufferLists; Current != NULL; Current = NET_BUFFER_LIST_NEXT_NBL(Current))
+    {
+        if (IndicatedCount < MAX_CHAIN)
+        {
+            Indicated[IndicatedCount++] = Current->Index;
+        }
+
+        Count++;
+    }
+
+    if (Count != NumberOfNetBufferLists)
+    {
+        IndicateErrors++;
+    }
+}
+
+
+VOID
+ChainAppend(
+    _Inout_ PFILTER_NBL_CHAIN       Chain,
+    _In_ PNET_BUFFER_LIST           Nbl
+    )
+{
+    if (Chain->Head == NULL)
+    {
+        Chain->Head = Nbl;
+    }
+    else
+    {
+        NET_BUFFER_LIST_NEXT_NBL(Chain->Tail) = Nbl;
+    }
+
+    Chain->Tail = Nbl;
+    Chain->Count++;
+}
+
+
+VOID
+SplitOneByOne(
+    _In_ PMS_FILTER                 pFilter,
+    _In_ PNET_BUFFER_LIST           NetBufferLists,
+    _Out_ PFILTER_NBL_CHAIN         PassChain,
+    _Out_ PFILTER_NBL_CHAIN         DropChain
+    )
+{
+    PNET_BUFFER_LIST    Current;
+    PNET_BUFFER_LIST    Next;
+
+    ZeroMemory(PassChain, sizeof(FILTER_NBL_CHAIN));
+    ZeroMemory(DropChain, sizeof(FILTER_NBL_CHAIN));
+
+    for (Current = NetBufferLists; Current != NULL; Current = Next)
+    {
+        Next = NET_BUFFER_LIST_NEXT_NBL(Current);
+        NET_BUFFER_LIST_NEXT_NBL(Current) = NULL;
+
+        ChainAppend(pFilter->ClassifyHandler(pFilter->ClassifyContext, Current, 1, FALSE) ? DropChain : PassChain,
+                    Current);
+    }
+}
+
+
+VOID
+SplitChain(
+    _In_ PMS_FILTER                 pFilter,
+    _In_ PNET_BUFFER_LIST           NetBufferLists,
+    _Out_ PFILTER_NBL_CHAIN         PassChain,
+    _Out_ PFILTER_NBL_CHAIN         DropChain
+    )
+{
+    filterClassifyChain(pFilter, NetBufferLists, FALSE, PassChain, DropChain);
+}
+
+
+VOID
+IndicateOneByOne(
+    _In_ PMS_FILTER                 pFilter,
+    _In_ PNET_BUFFER_LIST           NetBufferLists,
+    _Out_ PFILTER_NBL_CHAIN         PassChain,
+    _Out_ PFILTER_NBL_CHAIN         DropChain
+    )
+{
+    PNET_BUFFER_LIST    Current;
+    PNET_BUFFER_LIST    Next;
+
+    ZeroMemory(PassChain, sizeof(FILTER_NBL_CHAIN));
+    ZeroMemory(DropChain, sizeof(FILTER_NBL_CHAIN));
+
+    for (Current = NetBufferLists; Current != NULL; Current = Next)
+    {
+        Next = NET_BUFFER_LIST_NEXT_NBL(Current);
+        NET_BUFFER_LIST_NEXT_NBL(Current) = NULL;
+
+        if (pFilter->ClassifyHandler(pFilter->ClassifyContext, Current, 1, TRUE) == 0)
+        {
+            NdisFIndicateReceiveNetBufferLists(pFilter->FilterHandle, Current, 0, 1, NDIS_RECEIVE_FLAGS_RESOURCES);
+        }
+
+        NET_BUFFER_LIST_NEXT_NBL(Current) = Next;
+    }
+}
+
+
+VOID
+IndicateChain(
+    _In_ PMS_FILTER                 pFilter,
+    _In_ PNET_BUFFER_LIST           NetBufferLists,
+    _Out_ PFILTER_NBL_CHAIN         PassChain,
+    _Out_ PFILTER_NBL_CHAIN         DropChain
+    )
+{
+    ZeroMemory(PassChain, sizeof(FILTER_NBL_CHAIN));
+    ZeroMemory(DropChain, sizeof(FILTER_NBL_CHAIN));
+
+    filterIndicateClassified(pFilter, NetBufferLists, 0, NDIS_RECEIVE_FLAGS_RESOURCES);
+}
+
+
+//
+// The one at a time version of each pair comes first; it is the one the
+// other is compared against.
+//
+
+BENCH_ROUTINE Routines[] = {
+    { "Split 1x1",    SplitOneByOne,    FALSE },
+    { "Split chain",  SplitChain,       FALSE },
+    { "Ind 1x1",      IndicateOneByOne, TRUE },
+    { "Ind chain",    IndicateChain,    TRUE },
+};
+
+//
+// A single NBL, a typical receive indication, exactly one batch, and chains
+// of several batches, as coalesced receives and large sends give.
+//
+
+const ULONG Lengths[] = { 1, 16, 64, 256, 1024 };
+
+//
+// Everything passes, as it mostly does; everything is dropped; one NBL in
+// 64 is dropped, so most batches split into three runs; every other one is
+// dropped, the worst case for runs; and half are dropped at random.
+//
+
+const BENCH_PATTERN Patterns[] = {
+    { "pass",    0, FALSE },
+    { "drop",    1, FALSE },
+    { "1/64",   64, FALSE },
+    { "1/2",     2, FALSE },
+    { "random",  0, TRUE },
+};
+
+
+VOID
+FillVerdicts(
+    _In_ const BENCH_PATTERN       *Pattern
+    )
+{
+    ULONG   Seed = 0x12345678;
+    ULONG   i;
+
+    for (i = 0; i < MAX_CHAIN; i++)
+    {
+        if (Pattern->Random)
+        {
+            Seed = Seed * 1664525 + 1013904223;
+            Verdict[i] = (UCHAR)(Seed >> 31);
+        }
+        else if (Pattern->DropEvery != 0)
+        {
+            Verdict[i] = (UCHAR)((i % Pattern->DropEvery) == (Pattern->DropEvery - 1));
+        }
+        else
+        {
+            Verdict[i] = 0;
+        }
+    }
+}
+
+
+PNET_BUFFER_LIST
+LinkChain(
+    _In_ ULONG                      Length
+    )
+{
+    ULONG   i;
+
+    for (i = 0; i + 1 < Length; i++)
+    {
+        NET_BUFFER_LIST_NEXT_NBL(&Nbls[i]) = &Nbls[i + 1];
+    }
+
+    NET_BUFFER_LIST_NEXT_NBL(&Nbls[Length - 1]) = NULL;
+
+    return &Nbls[0];
+}
+
+
+BOOLEAN
+CheckChain(
+    _In_ const FILTER_NBL_CHAIN    *Chain,
+    _In_ ULONG                      Length,
+    _In_ UCHAR                      Drop
+    )
+/*++
+
+Routine Description:
+
+    Checks that Chain holds exactly the NBLs whose verdict is Drop, in
+    order.
+
+--*/
+{
+    PNET_BUFFER_LIST    Current = Chain->Head;
+    ULONG               Count = 0;
+    ULONG               i;
+
+    for (i = 0; i < Length; i++)
+    {
+        if (Verdict[i] != Drop)
+        {
+            continue;
+        }
+
+        if (Current == NULL || Current->Index != i)
+        {
+            return FALSE;
+        }
+
+        Current = NET_BUFFER_LIST_NEXT_NBL(Current);
+        Count++;
+    }
+
+    return (BOOLEAN)(Current == NULL && Count == Chain->Count);
+}
+
+
+BOOLEAN
+CheckRoutine(
+    _In_ PBENCH_ROUTINE             Routine,
+    _In_ PMS_FILTER                 pFilter,
+    _In_ ULONG                      Length
+    )
+/*++
+
+Routine Description:
+
+    Runs Routine once and checks what it passed and dropped against the
+    verdict table.
+
+--*/
+{
+    FILTER_NBL_CHAIN    PassChain;
+    FILTER_NBL_CHAIN    DropChain;
+    PNET_BUFFER_LIST    Current;
+    ULONG               Count = 0;
+    ULONG               i;
+
+    IndicatedCount = 0;
+    IndicateErrors = 0;
+
+    Routine->Routine(pFilter, LinkChain(Length), &PassChain, &DropChain);
+
+    if (!Routine->Indicates)
+    {
+        return (BOOLEAN)(CheckChain(&PassChain, Length, 0) && CheckChain(&DropChain, Length, 1));
+    }
+
+    if (IndicateErrors != 0)
+    {
+        return FALSE;
+    }
+
+    for (i = 0; i < Length; i++)
+    {
+        if (Verdict[i] == 0 && (Count >= IndicatedCount || Indicated[Count++] != i))
+        {
+            return FALSE;
+        }
+    }
+
+    if (Count != IndicatedCount)
+    {
+        return FALSE;
+    }
+
+    //
+    // The miniport's chain has to be left as it was.
+    //
+    for (Current = &Nbls[0], i = 0; Current != NULL; Current = NET_BUFFER_LIST_NEXT_NBL(Current), i++)
+    {
+        if (Current->Index != i)
+        {
+            return FALSE;
+        }
+    }
+
+    return (BOOLEAN)(i == Length);
+}
+
+
+double
+TimeRoutine(
+    _In_ PBENCH_ROUTINE             Routine,
+    _In_ PMS_FILTER                 pFilter,
+    _In_ ULONG                      Length,
+    _In_ ULONG                      Milliseconds
+    )
+/*++
+
+Routine Description:
+
+    Returns the average time of one call in nanoseconds.
+
+--*/
+{
+    FILTER_NBL_CHAIN    PassChain;
+    FILTER_NBL_CHAIN    DropChain;
+    LARGE_INTEGER       Start;
+    LARGE_INTEGER       Now;
+    LONGLONG            Budget;
+    ULONGLONG           Calls = 0;
+    ULONG               i;
+
+    //
+    // Warm up the caches and the branch predictors.
+    //
+    for (i = 0; i < 16; i++)
+    {
+        IndicatedCount = 0;
+        Routine->Routine(pFilter, LinkChain(Length), &PassChain, &DropChain);
+    }
+
+    Budget = Frequency.QuadPart * Milliseconds / 1000;
+
+    QueryPerformanceCounter(&Start);
+
+    do
+    {
+        for (i = 0; i < 16; i++)
+        {
+            IndicatedCount = 0;
+            Routine->Routine(pFilter, LinkChain(Length), &PassChain, &DropChain);
+        }
+
+        Calls += 16;
+
+        QueryPerformanceCounter(&Now);
+
+    } while (Now.QuadPart - Start.QuadPart < Budget);
+
+    return (double)(Now.QuadPart - Start.QuadPart) * 1e9 / (double)Frequency.QuadPart / (double)Calls;
+}
+
+
+VOID
+Usage(
+    VOID
+    )
+{
+    printf("Usage: classifyBench [-Milliseconds <n>] [-CallCost <n>]\n");
+    printf("    -Milliseconds   time spent on each case (default %d)\n", DEFAULT_MILLISECONDS);
+    printf("    -CallCost       busy loop iterations added to each classifier and\n");
+    printf("                    indication call (default %d)\n", DEFAULT_CALL_COST);
+}
+
+
+int
+__cdecl
+main(
+    _In_ int                        argc,
+    _In_reads_(argc) char          *argv[]
+    )
+{
+    ULONG       Milliseconds = DEFAULT_MILLISECONDS;
+    MS_FILTER   Filter;
+    int         Argument;
+    int         Failures = 0;
+    ULONG       l, p, r, i;
+    double      Baseline = 0.0;
+    double      Time;
+
+    for (Argument = 1; Argument < argc; Argument++)
+    {
+        if ((_stricmp(argv[Argument], "-Milliseconds") == 0) && (Argument + 1 < argc))
+        {
+            Milliseconds = strtoul(argv[++Argument], NULL, 0);
+        }
+        else if ((_stricmp(argv[Argument], "-CallCost") == 0) && (Argument + 1 < argc))
+        {
+            CallCost = strtoul(argv[++Argument], NULL, 0);
+        }
+        else
+        {
+            Usage();
+            return 1;
+        }
+    }
+
+    if (Milliseconds == 0)
+    {
+        Usage();
+        return 1;
+    }
+
+    Nbls = VirtualAlloc(NULL, MAX_CHAIN * sizeof(NET_BUFFER_LIST), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+    if (Nbls == NULL)
+    {
+        printf("Out of memory\n");
+        return 1;
+    }
+
+    for (i = 0; i < MAX_CHAIN; i++)
+    {
+        Nbls[i].Index = i;
+    }
+
+    ZeroMemory(&Filter, sizeof(Filter));
+    Filter.State = FilterPaused;
+    filterSetClassifyHandler(&Filter, BenchClassify, Verdict);
+
+    QueryPerformanceFrequency(&Frequency);
+
+    //
+    // Keep the timing thread on one processor and ahead of the rest of
+    // the system.
+    //
+    SetThreadAffinityMask(GetCurrentThread(), 1);
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+
+    printf("%-12s %6s %-7s %12s %10s %8s\n",
+           "Routine", "NBLs", "Drops", "ns/call", "ns/NBL", "vs 1x1");
+
+    for (l = 0; l < ARRAYSIZE(Lengths); l++)
+    {
+        for (p = 0; p < ARRAYSIZE(Patterns); p++)
+        {
+            FillVerdicts(&Patterns[p]);
+
+            for (r = 0; r < ARRAYSIZE(Routines); r++)
+            {
+                if (!CheckRoutine(&Routines[r], &Filter, Lengths[l]))
+                {
+                    printf("%-12s %6u %-7s    MISMATCH against the verdicts\n",
+                           Routines[r].Name, Lengths[l], Patterns[p].Name);
+                    Failures++;
+                    continue;
+                }
+
+                Time = TimeRoutine(&Routines[r], &Filter, Lengths[l], Milliseconds);
+
+                if ((r % 2) == 0)
+                {
+                    Baseline = Time;
+                }
+
+                printf("%-12s %6u %-7s %12.1f %10.2f %7.2fx\n",
+                       Routines[r].Name,
+                       Lengths[l],
+                       Patterns[p].Name,
+                       Time,
+                       Time / Lengths[l],
+                       Baseline / Time);
+            }
+        }
+    }
+
+    VirtualFree(Nbls, 0, MEM_RELEASE);
+
+    if (Failures != 0)
+    {
+        printf("\n%d routine checks failed\n", Failures);
+        return 2;
+    }
+
+    return 0;
+}
@@ -0,0 +1,139 @@
+/*++
+
+Copyright (c) Microsoft Corporation
+
+Module Name:
+
+    classifyBench.h
+
+Abstract:
+
+    The parts of ndis.h and filter.h that classify.c uses, for building it
+    into the user mode benchmark.  Only the NBL link counts for the chain
+    handling, so NET_BUFFER_LIST here is the link, an index the benchmark
+    classifier looks the verdict up by, and padding to about the size of
+    the real structure so that walking a chain touches as many cache
+    lines.
+
+    The classification declarations must be kept the same as in filter.h.
+
+Environment:
+
+    User mode
+
+--*/
+
+#ifndef _CLASSIFY_BENCH_H
+#define _CLASSIFY_BENCH_H
+
+#include <DriverSpecs.h>
+#include <windows.h>
+
+#ifndef PASSIVE_LEVEL
+#define PASSIVE_LEVEL 0
+#endif
+
+#ifndef DISPATCH_LEVEL
+#define DISPATCH_LEVEL 2
+#endif
+
+typedef PVOID NDIS_HANDLE;
+typedef ULONG NDIS_PORT_NUMBER;
+
+typedef struct _NET_BUFFER_LIST
+{
+    struct _NET_BUFFER_LIST        *Next;
+    ULONG                           Index;
+    UCHAR                           Reserved[176 - sizeof(PVOID) - sizeof(ULONG)];
+} NET_BUFFER_LIST, *PNET_BUFFER_LIST;
+
+#define NET_BUFFER_LIST_NEXT_NBL(_NBL)          ((_NBL)->Next)
+
+#define NDIS_RECEIVE_FLAGS_RESOURCES            0x00000002
+#define NDIS_TEST_RECEIVE_CANNOT_PEND(_Flags)   (((_Flags) & NDIS_RECEIVE_FLAGS_RESOURCES) != 0)
+
+#define NdisZeroMemory(_Destination, _Length)   ZeroMemory(_Destination, _Length)
+
+#define FILTER_ASSERT(exp)
+
+VOID
+NdisFIndicateReceiveNetBufferLists(
+    _In_ NDIS_HANDLE                NdisFilterHandle,
+    _In_ PNET_BUFFER_LIST           NetBufferLists,
+    _In_ NDIS_PORT_NUMBER           PortNumber,
+    _In_ ULONG                      NumberOfNetBufferLists,
+    _In_ ULONG                      ReceiveFlags
+    );
+
+typedef enum _FILTER_STATE
+{
+    FilterStateUnspecified,
+    FilterInitialized,
+    FilterPausing,
+    FilterPaused,
+    FilterRunning,
+    FilterRestarting,
+    FilterDetaching
+} FILTER_STATE;
+
+#define FILTER_CLASSIFY_BATCH       64
+
+typedef
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_Function_class_(FILTER_CLASSIFY_CHAIN)
+ULONG64
+(FILTER_CLASSIFY_CHAIN)(
+    _In_opt_ PVOID                  ClassifyContext,
+    _In_ PNET_BUFFER_LIST           NetBufferLists,
+    _In_ ULONG                      NumberOfNetBufferLists,
+    _In_ BOOLEAN                    Receive
+    );
+
+typedef FILTER_CLASSIFY_CHAIN *PFILTER_CLASSIFY_CHAIN;
+
+typedef struct _FILTER_NBL_CHAIN
+{
+    PNET_BUFFER_LIST                Head;
+    PNET_BUFFER_LIST                Tail;
+    ULONG                           Count;
+} FILTER_NBL_CHAIN, *PFILTER_NBL_CHAIN;
+
+//
+// The fields of MS_FILTER that classify.c uses.
+//
+typedef struct _MS_FILTER
+{
+    NDIS_HANDLE                     FilterHandle;
+    FILTER_STATE                    State;
+    PFILTER_CLASSIFY_CHAIN          ClassifyHandler;
+    PVOID                           ClassifyContext;
+} MS_FILTER, *PMS_FILTER;
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+filterSetClassifyHandler(
+    _In_ PMS_FILTER                   pFilter,
+    _In_opt_ PFILTER_CLASSIFY_CHAIN   ClassifyHandler,
+    _In_opt_ PVOID                    ClassifyContext
+    );
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+filterClassifyChain(
+    _In_ PMS_FILTER                   pFilter,
+    _In_ PNET_BUFFER_LIST             NetBufferLists,
+    _In_ BOOLEAN                      Receive,
+    _Out_ PFILTER_NBL_CHAIN           PassChain,
+    _Out_ PFILTER_NBL_CHAIN           DropChain
+    );
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+filterIndicateClassified(
+    _In_ PMS_FILTER                   pFilter,
+    _In_ PNET_BUFFER_LIST             NetBufferLists,
+    _In_ NDIS_PORT_NUMBER             PortNumber,
+    _In_ ULONG                        ReceiveFlags
+    );
+
+#endif  //_CLASSIFY_BENCH_H
@@ -0,0 +1,663 @@
+/*++
+ *
+ * The file contains the packet capture ring.  Packet headers are copied
+ * into a ring of fixed-size frames in a buffer the application supplies
+ * with IOCTL_FILTER_START_CAPTURE, see filteruser.h for the layout and
+ * the producer/consumer protocol.  The start IRP stays pending for as long
+ * as the capture runs, so the buffer stays locked and nothing of the
+ * driver's is ever mapped into the application.
+ *
+-- */
+
+#include "precomp.h"
+
+#define __FILENUMBER    'PACF'
+
+
+//
+// Serializes starting, stopping and cancelling captures, which all run at
+// PASSIVE_LEVEL.  The cancel routine itself only queues a work item.
+//
+NDIS_MUTEX          FilterCaptureMutex;
+
+static KDEFERRED_ROUTINE filterCaptureWakeupDpc;
+static DRIVER_CANCEL filterCaptureCancel;
+static IO_WORKITEM_ROUTINE filterCaptureCancelWorker;
+
+_Use_decl_annotations_
+static
+VOID
+filterCaptureWakeupDpc(
+    PKDPC                 Dpc,
+    PVOID                 DeferredContext,
+    PVOID                 SystemArgument1,
+    PVOID                 SystemArgument2
+    )
+/*++
+
+Routine Description:
+
+    Periodic flush of batched wakeups, so that a consumer waiting for a
+    batch that never fills still hears about the frames that did arrive.
+
+--*/
+{
+    PFILTER_CAPTURE       Capture = (PFILTER_CAPTURE)DeferredContext;
+
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    if (InterlockedExchange(&Capture->PendingWakeups, 0) != 0)
+    {
+        KeSetEvent(Capture->Event, IO_NETWORK_INCREMENT, FALSE);
+    }
+}
+
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+static
+VOID
+filterFreeCapture(
+    _In_ PFILTER_CAPTURE          Capture
+    )
+/*++
+
+Routine Description:
+
+    Free a capture that is no longer published to the datapath.  The
+    buffer belongs to the start IRP and is not touched.
+
+--*/
+{
+    FILTER_ASSERT(Capture->Filter == NULL);
+
+    KeCancelTimer(&Capture->WakeupTimer);
+    KeFlushQueuedDpcs();
+
+    if (Capture->Event != NULL)
+    {
+        ObDereferenceObject(Capture->Event);
+    }
+
+    if (Capture->CancelWorkItem != NULL)
+    {
+        IoFreeWorkItem(Capture->CancelWorkItem);
+    }
+
+    FILTER_FREE_MEM(Capture);
+}
+
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+_Requires_lock_held_(FilterCaptureMutex)
+static
+VOID
+filterEndCapture(
+    _In_ PFILTER_CAPTURE          Capture,
+    _In_ NTSTATUS                 Status
+    )
+/*++
+
+Routine Description:
+
+    End a capture whose start IRP the caller owns: unpublish it, wait for
+    the datapath to stop writing into the buffer, then free the capture
+    and complete the start IRP with Status.
+
+--*/
+{
+    PMS_FILTER            pFilter;
+    PIRP                  Irp = Capture->Irp;
+    BOOLEAN               bFalse = FALSE;
+
+    //
+    // The pending IRP keeps the file object referenced.
+    //
+    if (Capture->FileObject->FsContext == Capture)
+    {
+        Capture->FileObject->FsContext = NULL;
+    }
+
+    FILTER_ACQUIRE_LOCK(&FilterListLock, bFalse);
+
+    pFilter = Capture->Filter;
+    Capture->Filter = NULL;
+
+    if (pFilter != NULL)
+    {
+        FILTER_ASSERT(pFilter->Capture == Capture);
+        pFilter->Capture = NULL;
+        pFilter->CaptureStops++;
+    }
+
+    FILTER_RELEASE_LOCK(&FilterListLock, bFalse);
+
+    //
+    // CaptureStops keeps FilterDetach from freeing the filter module while
+    // we wait on its rundown reference.
+    //
+    if (pFilter != NULL)
+    {
+        ExWaitForRundownProtectionReleaseCacheAware(pFilter->CaptureRundown);
+        ExReInitializeRundownProtectionCacheAware(pFilter->CaptureRundown);
+
+        FILTER_ACQUIRE_LOCK(&FilterListLock, bFalse);
+        pFilter->CaptureStops--;
+        if (pFilter->CaptureStops == 0)
+        {
+            NdisSetEvent(&pFilter->CaptureStopsDone);
+        }
+        FILTER_RELEASE_LOCK(&FilterListLock, bFalse);
+    }
+
+    filterFreeCapture(Capture);
+
+    Irp->IoStatus.Status = Status;
+    Irp->IoStatus.Information = 0;
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+}
+
+
+_Use_decl_annotations_
+static
+VOID
+filterCaptureCancel(
+    PDEVICE_OBJECT        DeviceObject,
+    PIRP                  Irp
+    )
+/*++
+
+Routine Description:
+
+    Cancel routine of the start IRP, which is how a capture ends when its
+    thread exits.  Waiting for the datapath takes PASSIVE_LEVEL, so the
+    capture is ended from a work item.
+
+--*/
+{
+    PFILTER_CAPTURE       Capture = (PFILTER_CAPTURE)Irp->Tail.Overlay.DriverContext[0];
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    IoReleaseCancelSpinLock(Irp->CancelIrql);
+
+    IoQueueWorkItem(Capture->CancelWorkItem, filterCaptureCancelWorker, DelayedWorkQueue, Capture);
+}
+
+
+_Use_decl_annotations_
+static
+VOID
+filterCaptureCancelWorker(
+    PDEVICE_OBJECT        DeviceObject,
+    PVOID                 Context
+    )
+{
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    //
+    // The cancel routine ran, so nobody else can end the capture.
+    //
+    NDIS_WAIT_FOR_MUTEX(&FilterCaptureMutex);
+    filterEndCapture((PFILTER_CAPTURE)Context, STATUS_CANCELLED);
+    NDIS_RELEASE_MUTEX(&FilterCaptureMutex);
+}
+
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+filterStartCapture(
+    _In_ PDEVICE_OBJECT               DeviceObject,
+    _In_ PIRP                         Irp,
+    _In_ PFILTER_START_CAPTURE        StartCapture
+    )
+/*++
+
+Routine Description:
+
+    Handle IOCTL_FILTER_START_CAPTURE: lay the ring out in the output
+    buffer of the IRP, publish the capture to the named filter module, and
+    keep the IRP pending until the capture is stopped or cancelled.
+
+Arguments:
+
+    DeviceObject    - the filter's control device
+    Irp             - the start IRP; its file object owns the capture
+    StartCapture    - capture parameters from the caller
+
+Return Value:
+
+    STATUS_PENDING once the capture runs; the IRP is completed when it
+    ends.  Otherwise STATUS_INVALID_PARAMETER for bad parameters or an
+    unknown instance, STATUS_BUFFER_TOO_SMALL if the ring does not fit in
+    the output buffer, STATUS_DEVICE_BUSY if the handle or the filter
+    module is already capturing, or the failure from setting up the capture.
+
+--*/
+{
+    NTSTATUS              Status = STATUS_SUCCESS;
+    PIO_STACK_LOCATION    IrpSp = IoGetCurrentIrpStackLocation(Irp);
+    PFILTER_CAPTURE       Capture = NULL;
+    PFILTER_CAPTURE_RING_HEADER   Ring;
+    PMS_FILTER            pFilter;
+    PLIST_ENTRY           Link;
+    ULONG                 FrameCount = StartCapture->FrameCount;
+    ULONG                 SnapLength = StartCapture->SnapLength;
+    ULONG                 FrameSize;
+    ULONG                 WakeupBatch;
+    ULONG64               RingSize;
+    LARGE_INTEGER         DueTime;
+    BOOLEAN               bFalse = FALSE;
+
+    NDIS_WAIT_FOR_MUTEX(&FilterCaptureMutex);
+
+    do
+    {
+        if (SnapLength == 0 ||
+            SnapLength > FILTER_CAPTURE_MAX_SNAPLENGTH ||
+            FrameCount < FILTER_CAPTURE_MIN_FRAMES ||
+            FrameCount > FILTER_CAPTURE_MAX_FRAMES ||
+            (FrameCount & (FrameCount - 1)) != 0 ||
+            StartCapture->InstanceNameLength > sizeof(StartCapture->InstanceName))
+        {
+            Status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        FrameSize = FILTER_CAPTURE_FRAME_SIZE(SnapLength);
+        RingSize = FILTER_CAPTURE_RING_SIZE(SnapLength, FrameCount);
+
+        if (RingSize > FILTER_CAPTURE_MAX_RING_SIZE)
+        {
+            Status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        if (Irp->MdlAddress == NULL ||
+            IrpSp->Parameters.DeviceIoControl.OutputBufferLength < RingSize)
+        {
+            Status = STATUS_BUFFER_TOO_SMALL;
+            break;
+        }
+
+        if ((MmGetMdlByteOffset(Irp->MdlAddress) & (FILTER_CAPTURE_FRAME_ALIGNMENT - 1)) != 0)
+        {
+            Status = STATUS_DATATYPE_MISALIGNMENT;
+            break;
+        }
+
+        if (IrpSp->FileObject->FsContext != NULL)
+        {
+            Status = STATUS_DEVICE_BUSY;
+            break;
+        }
+
+        //
+        // The I/O manager has locked the buffer for the IRP; the datapath
+        // writes it through a system address.
+        //
+        Ring = (PFILTER_CAPTURE_RING_HEADER)MmGetSystemAddressForMdlSafe(Irp->MdlAddress,
+                                                                         NormalPagePriority | MdlMappingNoExecute);
+        if (Ring == NULL)
+        {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        WakeupBatch = StartCapture->WakeupBatch;
+        if (WakeupBatch == 0)
+        {
+            WakeupBatch = FrameCount / 4;
+        }
+        else if (WakeupBatch > FrameCount)
+        {
+            WakeupBatch = FrameCount;
+        }
+
+        Capture = (PFILTER_CAPTURE)FILTER_ALLOC_MEM(FilterDriverHandle, sizeof(FILTER_CAPTURE));
+        if (Capture == NULL)
+        {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        NdisZeroMemory(Capture, sizeof(FILTER_CAPTURE));
+        Capture->Irp = Irp;
+        Capture->FileObject = IrpSp->FileObject;
+        Capture->Ring = Ring;
+        Capture->RingSize = (ULONG)RingSize;
+        Capture->FrameCount = FrameCount;
+        Capture->FrameSize = FrameSize;
+        Capture->SnapLength = SnapLength;
+        Capture->WakeupBatch = WakeupBatch;
+        KeInitializeTimer(&Capture->WakeupTimer);
+        KeInitializeDpc(&Capture->WakeupDpc, filterCaptureWakeupDpc, Capture);
+
+        Capture->CancelWorkItem = IoAllocateWorkItem(DeviceObject);
+        if (Capture->CancelWorkItem == NULL)
+        {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        if (StartCapture->EventHandle != 0)
+        {
+            Status = ObReferenceObjectByHandle((HANDLE)(ULONG_PTR)StartCapture->EventHandle,
+                                               EVENT_MODIFY_STATE,
+                                               *ExEventObjectType,
+                                               UserMode,
+                                               (PVOID *)&Capture->Event,
+                                               NULL);
+            if (!NT_SUCCESS(Status))
+            {
+                Capture->Event = NULL;
+                break;
+            }
+        }
+
+        NdisZeroMemory(Ring, Capture->RingSize);
+
+        Ring->HeaderSize = sizeof(FILTER_CAPTURE_RING_HEADER);
+        Ring->FrameSize = FrameSize;
+        Ring->FrameCount = FrameCount;
+        Ring->SnapLength = SnapLength;
+
+        //
+        // Look the filter module up and publish the capture to it under the
+        // same hold of FilterListLock, so that it cannot detach in between.
+        //
+        FILTER_ACQUIRE_LOCK(&FilterListLock, bFalse);
+
+        pFilter = NULL;
+        Link = FilterModuleList.Flink;
+
+        while (Link != &FilterModuleList)
+        {
+            PMS_FILTER    pCurrent = CONTAINING_RECORD(Link, MS_FILTER, FilterModuleLink);
+
+            if (StartCapture->InstanceNameLength >= pCurrent->FilterModuleName.Length &&
+                NdisEqualMemory(StartCapture->InstanceName,
+                                pCurrent->FilterModuleName.Buffer,
+                                pCurrent->FilterModuleName.Length))
+            {
+                pFilter = pCurrent;
+                break;
+            }
+
+            Link = Link->Flink;
+        }
+
+        if (pFilter == NULL)
+        {
+            Status = STATUS_INVALID_PARAMETER;
+        }
+        else if (pFilter->Capture != NULL || pFilter->CaptureStops != 0)
+        {
+            Status = STATUS_DEVICE_BUSY;
+        }
+        else
+        {
+            Capture->Filter = pFilter;
+            pFilter->Capture = Capture;
+        }
+
+        FILTER_RELEASE_LOCK(&FilterListLock, bFalse);
+
+        if (!NT_SUCCESS(Status))
+        {
+            break;
+        }
+
+        IrpSp->FileObject->FsContext = Capture;
+
+        if (Capture->Event != NULL)
+        {
+            DueTime.QuadPart = -10000LL * FILTER_CAPTURE_WAKEUP_INTERVAL_MS;
+            KeSetTimerEx(&Capture->WakeupTimer,
+                         DueTime,
+                         FILTER_CAPTURE_WAKEUP_INTERVAL_MS,
+                         &Capture->WakeupDpc);
+        }
+
+        Irp->Tail.Overlay.DriverContext[0] = Capture;
+        IoMarkIrpPending(Irp);
+        IoSetCancelRoutine(Irp, filterCaptureCancel);
+
+        //
+        // If the IRP was cancelled before the cancel routine was set, and
+        // we got the routine back, nobody else will end the capture.
+        //
+        if (Irp->Cancel && IoSetCancelRoutine(Irp, NULL) != NULL)
+        {
+            filterEndCapture(Capture, STATUS_CANCELLED);
+        }
+
+        Status = STATUS_PENDING;
+
+    } while (bFalse);
+
+    if (!NT_SUCCESS(Status) && Capture != NULL)
+    {
+        filterFreeCapture(Capture);
+    }
+
+    NDIS_RELEASE_MUTEX(&FilterCaptureMutex);
+
+    return Status;
+}
+
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+filterStopCapture(
+    _In_ PFILE_OBJECT                 FileObject
+    )
+/*++
+
+Routine Description:
+
+    Handle IOCTL_FILTER_STOP_CAPTURE, and IRP_MJ_CLEANUP of a handle that
+    still has a capture running: end the capture and complete its start
+    IRP.  If the start IRP is being cancelled, the cancel work item ends
+    the capture instead.
+
+Arguments:
+
+    FileObject      - the handle the capture was started on
+
+Return Value:
+
+    STATUS_SUCCESS, or STATUS_INVALID_DEVICE_STATE if the handle has no
+    capture.
+
+--*/
+{
+    PFILTER_CAPTURE       Capture;
+
+    NDIS_WAIT_FOR_MUTEX(&FilterCaptureMutex);
+
+    Capture = (PFILTER_CAPTURE)FileObject->FsContext;
+    if (Capture == NULL)
+    {
+        NDIS_RELEASE_MUTEX(&FilterCaptureMutex);
+        return STATUS_INVALID_DEVICE_STATE;
+    }
+
+    //
+    // Whoever takes the cancel routine back owns the start IRP.
+    //
+    if (IoSetCancelRoutine(Capture->Irp, NULL) != NULL)
+    {
+        filterEndCapture(Capture, STATUS_SUCCESS);
+    }
+
+    NDIS_RELEASE_MUTEX(&FilterCaptureMutex);
+
+    return STATUS_SUCCESS;
+}
+
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+filterDetachCapture(
+    _In_ PMS_FILTER                   pFilter
+    )
+/*++
+
+Routine Description:
+
+    Called from FilterDetach once the filter module is off FilterModuleList.
+    The filter is paused, so the datapath is not using the capture and it
+    can simply be unpublished; the handle that owns it frees it later.
+    Then wait for any filterStopCapture still using the filter module.
+
+--*/
+{
+    BOOLEAN               bFalse = FALSE;
+
+    FILTER_ACQUIRE_LOCK(&FilterListLock, bFalse);
+
+    if (pFilter->Capture != NULL)
+    {
+        pFilter->Capture->Filter = NULL;
+        pFilter->Capture = NULL;
+    }
+
+    while (pFilter->CaptureStops != 0)
+    {
+        NdisResetEvent(&pFilter->CaptureStopsDone);
+        FILTER_RELEASE_LOCK(&FilterListLock, bFalse);
+
+        NdisWaitEvent(&pFilter->CaptureStopsDone, 0);
+
+        FILTER_ACQUIRE_LOCK(&FilterListLock, bFalse);
+    }
+
+    FILTER_RELEASE_LOCK(&FilterListLock, bFalse);
+}
+
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+static
+VOID
+filterCaptureNetBuffer(
+    _In_ PFILTER_CAPTURE              Capture,
+    _In_ PNET_BUFFER                  NetBuffer,
+    _In_ ULONG                        Flags,
+    _In_ ULONG64                      Timestamp
+    )
+{
+    PFILTER_CAPTURE_RING_HEADER   Ring = Capture->Ring;
+    PFILTER_CAPTURE_FRAME         Frame;
+    PVOID                         Data;
+    LONG                          Producer;
+    ULONG                         Length;
+    ULONG                         Captured;
+
+    //
+    // Reserve a frame.  The consumer index comes from user mode and is not
+    // trusted for anything but deciding whether the ring is full; the
+    // frame address is always masked into the ring.
+    //
+    do
+    {
+        Producer = Capture->ProducerIndex;
+
+        if ((ULONG)Producer - Ring->ConsumerIndex >= Capture->FrameCount)
+        {
+            InterlockedIncrement64(&Ring->DroppedFrames);
+            return;
+        }
+    } while (InterlockedCompareExchange(&Capture->ProducerIndex, Producer + 1, Producer) != Producer);
+
+    Frame = (PFILTER_CAPTURE_FRAME)((PUCHAR)Ring +
+                                    sizeof(FILTER_CAPTURE_RING_HEADER) +
+                                    ((ULONG)Producer & (Capture->FrameCount - 1)) * Capture->FrameSize);
+
+    Length = NET_BUFFER_DATA_LENGTH(NetBuffer);
+    Captured = min(Length, Capture->SnapLength);
+
+    if (Captured != 0)
+    {
+        Data = NdisGetDataBuffer(NetBuffer, Captured, Frame->Data, 1, 0);
+        if (Data == NULL)
+        {
+            Captured = 0;
+        }
+        else if (Data != Frame->Data)
+        {
+            NdisMoveMemory(Frame->Data, Data, Captured);
+        }
+    }
+
+    Frame->Flags = Flags | ((Captured < Length) ? FILTER_CAPTURE_FRAME_TRUNCATED : 0);
+    Frame->OriginalLength = Length;
+    Frame->CapturedLength = Captured;
+    Frame->Timestamp = Timestamp;
+
+    //
+    // Hand the frame to the consumer only once it is complete.
+    //
+    InterlockedExchange(&Frame->Status, FILTER_CAPTURE_FRAME_READY);
+
+    if (Capture->Event != NULL &&
+        (ULONG)InterlockedIncrement(&Capture->PendingWakeups) >= Capture->WakeupBatch)
+    {
+        InterlockedExchange(&Capture->PendingWakeups, 0);
+        KeSetEvent(Capture->Event, IO_NETWORK_INCREMENT, FALSE);
+    }
+}
+
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+filterCaptureNetBufferLists(
+    _In_ PMS_FILTER                   pFilter,
+    _In_ PNET_BUFFER_LIST             NetBufferLists,
+    _In_ BOOLEAN                      Receive
+    )
+/*++
+
+Routine Description:
+
+    Copy the front of every NET_BUFFER in the chain into the capture ring,
+    if the filter module has a capture running.  The chain is not modified.
+
+Arguments:
+
+    pFilter         - pointer to the filter module context
+    NetBufferLists  - the chain being sent or indicated
+    Receive         - TRUE on the receive path, FALSE on the send path
+
+--*/
+{
+    PFILTER_CAPTURE       Capture;
+    PNET_BUFFER_LIST      CurrNbl;
+    PNET_BUFFER           CurrNb;
+    ULONG64               Timestamp;
+    ULONG                 Flags = Receive ? FILTER_CAPTURE_FRAME_RECEIVE : 0;
+
+    if (!ExAcquireRundownProtectionCacheAware(pFilter->CaptureRundown))
+    {
+        return;
+    }
+
+    Capture = *(PFILTER_CAPTURE volatile *)&pFilter->Capture;
+
+    if (Capture != NULL)
+    {
+        Timestamp = KeQueryInterruptTime();
+
+        for (CurrNbl = NetBufferLists; CurrNbl != NULL; CurrNbl = NET_BUFFER_LIST_NEXT_NBL(CurrNbl))
+        {
+            for (CurrNb = NET_BUFFER_LIST_FIRST_NB(CurrNbl); CurrNb != NULL; CurrNb = NET_BUFFER_NEXT_NB(CurrNb))
+            {
+                filterCaptureNetBuffer(Capture, CurrNb, Flags, Timestamp);
+            }
+        }
+    }
+
+    ExReleaseRundownProtectionCacheAware(pFilter->CaptureRundown);
+}
+
@@ -0,0 +1,313 @@
+/*++
+ *
+ * The file contains the packet classification hook.  The classifier is
+ * handed NBL chains, not single NBLs, and the chains are only split where
+ * the verdict changes from one NBL to the next.
+ *
+ * The file is also built into the user mode benchmark in the bench
+ * directory, with bench\classifyBench.h standing in for ndis.h and the
+ * filter module context, so it does not use the precompiled header.
+ *
+-- */
+
+#if defined(_KERNEL_MODE)
+#include "precomp.h"
+#else
+#include "classifyBench.h"
+#endif
+
+
+static
+VOID
+filterChainAppend(
+    _Inout_ PFILTER_NBL_CHAIN         Chain,
+    _In_ PNET_BUFFER_LIST             RunHead,
+    _In_ PNET_BUFFER_LIST             RunTail,
+    _In_ ULONG                        RunCount
+    )
+{
+    NET_BUFFER_LIST_NEXT_NBL(RunTail) = NULL;
+
+    if (Chain->Head == NULL)
+    {
+        Chain->Head = RunHead;
+    }
+    else
+    {
+        NET_BUFFER_LIST_NEXT_NBL(Chain->Tail) = RunHead;
+    }
+
+    Chain->Tail = RunTail;
+    Chain->Count += RunCount;
+}
+
+
+static
+ULONG64
+filterClassifyBatch(
+    _In_ PMS_FILTER                   pFilter,
+    _In_ PNET_BUFFER_LIST             Batch,
+    _Out_ PNET_BUFFER_LIST           *BatchTail,
+    _Out_ PNET_BUFFER_LIST           *NextBatch,
+    _Out_ PULONG                      BatchCount,
+    _In_ BOOLEAN                      Receive
+    )
+/*++
+
+Routine Description:
+
+    Terminate the chain after at most FILTER_CLASSIFY_BATCH NBLs and run
+    the classifier over that batch.  *NextBatch receives the NBL the batch
+    was cut off from, which the caller links back onto *BatchTail if it
+    wants the original chain back.
+
+Return Value:
+
+    The drop bitmap for the batch, with bits past the end of the batch
+    cleared.
+
+--*/
+{
+    PNET_BUFFER_LIST    Tail = Batch;
+    ULONG               Count = 1;
+    ULONG64             Verdicts;
+
+    while (Count < FILTER_CLASSIFY_BATCH && NET_BUFFER_LIST_NEXT_NBL(Tail) != NULL)
+    {
+        Tail = NET_BUFFER_LIST_NEXT_NBL(Tail);
+        Count++;
+    }
+
+    *NextBatch = NET_BUFFER_LIST_NEXT_NBL(Tail);
+    NET_BUFFER_LIST_NEXT_NBL(Tail) = NULL;
+
+    Verdicts = pFilter->ClassifyHandler(pFilter->ClassifyContext, Batch, Count, Receive);
+
+    if (Count < FILTER_CLASSIFY_BATCH)
+    {
+        Verdicts &= (1ULL << Count) - 1;
+    }
+
+    *BatchTail = Tail;
+    *BatchCount = Count;
+
+    return Verdicts;
+}
+
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+filterSetClassifyHandler(
+    _In_ PMS_FILTER                   pFilter,
+    _In_opt_ PFILTER_CLASSIFY_CHAIN   ClassifyHandler,
+    _In_opt_ PVOID                    ClassifyContext
+    )
+/*++
+
+Routine Description:
+
+    Install or remove the packet classifier for a filter module.
+
+    The send and receive handlers read the classifier while holding the
+    datapath rundown reference, so it may only be changed while the filter
+    is paused (or still attaching, before its state is set), when that
+    reference is run down.
+
+Arguments:
+
+    pFilter         - pointer to the filter module context
+    ClassifyHandler - the classifier, or NULL to pass everything through
+    ClassifyContext - passed to the classifier on every call
+
+--*/
+{
+    FILTER_ASSERT(pFilter->State == FilterPaused || pFilter->State == FilterStateUnspecified);
+
+    pFilter->ClassifyHandler = ClassifyHandler;
+    pFilter->ClassifyContext = ClassifyContext;
+}
+
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+filterClassifyChain(
+    _In_ PMS_FILTER                   pFilter,
+    _In_ PNET_BUFFER_LIST             NetBufferLists,
+    _In_ BOOLEAN                      Receive,
+    _Out_ PFILTER_NBL_CHAIN           PassChain,
+    _Out_ PFILTER_NBL_CHAIN           DropChain
+    )
+/*++
+
+Routine Description:
+
+    Classify a chain of NBLs and split it into the NBLs to pass and the NBLs
+    to drop.  A batch with a uniform verdict is moved to the matching chain
+    as a whole; otherwise each run of NBLs with the same verdict is moved
+    as a unit, so the links inside a run are never touched.
+
+    Both output chains keep the original relative order of their NBLs.
+
+Arguments:
+
+    pFilter         - pointer to the filter module context
+    NetBufferLists  - the chain to classify; it is consumed
+    Receive         - TRUE on the receive path, FALSE on the send path
+    PassChain       - receives the NBLs to pass on
+    DropChain       - receives the NBLs to drop
+
+--*/
+{
+    PNET_BUFFER_LIST    Batch = NetBufferLists;
+    PNET_BUFFER_LIST    BatchTail;
+    PNET_BUFFER_LIST    NextBatch;
+    PNET_BUFFER_LIST    RunHead;
+    PNET_BUFFER_LIST    Current;
+    PNET_BUFFER_LIST    Next;
+    ULONG               BatchCount;
+    ULONG               RunCount;
+    ULONG               i;
+    ULONG64             Verdicts;
+    ULONG64             AllDropped;
+    BOOLEAN             Drop;
+
+    NdisZeroMemory(PassChain, sizeof(FILTER_NBL_CHAIN));
+    NdisZeroMemory(DropChain, sizeof(FILTER_NBL_CHAIN));
+
+    while (Batch != NULL)
+    {
+        Verdicts = filterClassifyBatch(pFilter, Batch, &BatchTail, &NextBatch, &BatchCount, Receive);
+
+        AllDropped = (BatchCount < FILTER_CLASSIFY_BATCH) ? ((1ULL << BatchCount) - 1) : ~0ULL;
+
+        if (Verdicts == 0)
+        {
+            filterChainAppend(PassChain, Batch, BatchTail, BatchCount);
+        }
+        else if (Verdicts == AllDropped)
+        {
+            filterChainAppend(DropChain, Batch, BatchTail, BatchCount);
+        }
+        else
+        {
+            RunHead = Batch;
+            RunCount = 0;
+            Current = Batch;
+
+            for (i = 0; i < BatchCount; i++)
+            {
+                Drop = (BOOLEAN)((Verdicts >> i) & 1);
+                Next = NET_BUFFER_LIST_NEXT_NBL(Current);
+                RunCount++;
+
+                if (i + 1 == BatchCount || (BOOLEAN)((Verdicts >> (i + 1)) & 1) != Drop)
+                {
+                    filterChainAppend(Drop ? DropChain : PassChain, RunHead, Current, RunCount);
+                    RunHead = Next;
+                    RunCount = 0;
+                }
+
+                Current = Next;
+            }
+        }
+
+        Batch = NextBatch;
+    }
+}
+
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+filterIndicateClassified(
+    _In_ PMS_FILTER                   pFilter,
+    _In_ PNET_BUFFER_LIST             NetBufferLists,
+    _In_ NDIS_PORT_NUMBER             PortNumber,
+    _In_ ULONG                        ReceiveFlags
+    )
+/*++
+
+Routine Description:
+
+    Classify a received chain that must not be pended (the miniport set
+    NDIS_RECEIVE_FLAGS_RESOURCES) and indicate up only the NBLs that pass.
+
+    Such a chain still belongs to the miniport when we return, so it cannot
+    be split for good.  Each run of passing NBLs is cut off temporarily,
+    indicated up as its own chain, and linked back in afterwards.
+
+Arguments:
+
+    pFilter         - pointer to the filter module context
+    NetBufferLists  - the received chain; it is intact again on return
+    PortNumber      - port the chain was received on
+    ReceiveFlags    - receive flags from the miniport
+
+--*/
+{
+    PNET_BUFFER_LIST    Batch = NetBufferLists;
+    PNET_BUFFER_LIST    BatchTail;
+    PNET_BUFFER_LIST    NextBatch;
+    PNET_BUFFER_LIST    RunHead;
+    PNET_BUFFER_LIST    Current;
+    PNET_BUFFER_LIST    Next;
+    ULONG               BatchCount;
+    ULONG               RunCount;
+    ULONG               i;
+    ULONG64             Verdicts;
+    BOOLEAN             Drop;
+
+    FILTER_ASSERT(NDIS_TEST_RECEIVE_CANNOT_PEND(ReceiveFlags));
+
+    while (Batch != NULL)
+    {
+        Verdicts = filterClassifyBatch(pFilter, Batch, &BatchTail, &NextBatch, &BatchCount, TRUE);
+
+        if (Verdicts == 0)
+        {
+            NdisFIndicateReceiveNetBufferLists(pFilter->FilterHandle,
+                                               Batch,
+                                               PortNumber,
+                                               BatchCount,
+                                               ReceiveFlags);
+        }
+        else
+        {
+            RunHead = Batch;
+            RunCount = 0;
+            Current = Batch;
+
+            for (i = 0; i < BatchCount; i++)
+            {
+                Drop = (BOOLEAN)((Verdicts >> i) & 1);
+                Next = NET_BUFFER_LIST_NEXT_NBL(Current);
+                RunCount++;
+
+                if (i + 1 == BatchCount || (BOOLEAN)((Verdicts >> (i + 1)) & 1) != Drop)
+                {
+                    if (!Drop)
+                    {
+                        NET_BUFFER_LIST_NEXT_NBL(Current) = NULL;
+                        NdisFIndicateReceiveNetBufferLists(pFilter->FilterHandle,
+                                                           RunHead,
+                                                           PortNumber,
+                                                           RunCount,
+                                                           ReceiveFlags);
+                        NET_BUFFER_LIST_NEXT_NBL(Current) = Next;
+                    }
+
+                    RunHead = Next;
+                    RunCount = 0;
+                }
+
+                Current = Next;
+            }
+        }
+
+        //
+        // Link the batch back onto the rest of the chain.
+        //
+        NET_BUFFER_LIST_NEXT_NBL(BatchTail) = NextBatch;
+        Batch = NextBatch;
+    }
+}
+
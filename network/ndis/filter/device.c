@@ -109,6 +109,13 @@ FilterDispatch(
             break;
 
         case IRP_MJ_CLEANUP:
+            //
+            // Closing the handle stops any capture it started.
+            //
+            if (IrpStack->FileObject != NULL)
+            {
+                filterStopCapture(IrpStack->FileObject);
+            }
             break;
 
         case IRP_MJ_CLOSE:
@@ -231,6 +238,36 @@ FilterDeviceIoControl(
             }
             break;
 
+        case IOCTL_FILTER_START_CAPTURE:
+
+            //
+            // METHOD_OUT_DIRECT: the parameters are in the system buffer,
+            // and the output buffer, which becomes the ring, is locked by
+            // the I/O manager.  The IRP stays pending while the capture runs.
+            //
+            InputBuffer = (PUCHAR)Irp->AssociatedIrp.SystemBuffer;
+            InputBufferLength = IrpSp->Parameters.DeviceIoControl.InputBufferLength;
+
+            if (InputBufferLength < sizeof(FILTER_START_CAPTURE))
+            {
+                Status = STATUS_BUFFER_TOO_SMALL;
+                break;
+            }
+
+            Status = filterStartCapture(DeviceObject,
+                                        Irp,
+                                        (PFILTER_START_CAPTURE)InputBuffer);
+            if (Status == STATUS_PENDING)
+            {
+                return Status;
+            }
+            break;
+
+        case IOCTL_FILTER_STOP_CAPTURE:
+
+            Status = filterStopCapture(IrpSp->FileObject);
+            break;
+
 
         default:
             break;
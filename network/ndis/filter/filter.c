@@ -140,6 +140,8 @@ Return Value:
         //
         FILTER_INIT_LOCK(&FilterListLock);
 
+        NDIS_INIT_MUTEX(&FilterCaptureMutex);
+
         InitializeListHead(&FilterModuleList);
 
         Status = NdisFRegisterFilterDriver(DriverObject,
@@ -337,6 +339,49 @@ N.B.:  FILTER can use NdisRegisterDeviceEx to create a device, so the upper
         pFilter->TrackSends = TRUE;
         pFilter->FilterHandle = NdisFilterHandle;
 
+        //
+        // Allocate the per-processor datapath counters, aligned so that no
+        // two processors share a cache line.
+        //
+        pFilter->CpuCount = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+        Size = pFilter->CpuCount * sizeof(FILTER_CPU_COUNTERS) + SYSTEM_CACHE_ALIGNMENT_SIZE;
+
+        pFilter->CpuCountersBuffer = FILTER_ALLOC_MEM(NdisFilterHandle, Size);
+        if (pFilter->CpuCountersBuffer == NULL)
+        {
+            DEBUGP(DL_WARN, "Failed to allocate per-processor counters.\n");
+            Status = NDIS_STATUS_RESOURCES;
+            break;
+        }
+
+        NdisZeroMemory(pFilter->CpuCountersBuffer, Size);
+        pFilter->CpuCounters = (PFILTER_CPU_COUNTERS)ALIGN_UP_POINTER_BY(pFilter->CpuCountersBuffer,
+                                                                         SYSTEM_CACHE_ALIGNMENT_SIZE);
+
+        //
+        // The filter starts out paused, so run down the datapath reference
+        // right away.  FilterRestart re-initializes it.
+        //
+        pFilter->DataPathRundown = ExAllocateCacheAwareRundownProtection(NonPagedPoolNx, FILTER_TAG);
+        if (pFilter->DataPathRundown == NULL)
+        {
+            DEBUGP(DL_WARN, "Failed to allocate datapath rundown protection.\n");
+            Status = NDIS_STATUS_RESOURCES;
+            break;
+        }
+
+        ExWaitForRundownProtectionReleaseCacheAware(pFilter->DataPathRundown);
+
+        pFilter->CaptureRundown = ExAllocateCacheAwareRundownProtection(NonPagedPoolNx, FILTER_TAG);
+        if (pFilter->CaptureRundown == NULL)
+        {
+            DEBUGP(DL_WARN, "Failed to allocate capture rundown protection.\n");
+            Status = NDIS_STATUS_RESOURCES;
+            break;
+        }
+
+        NdisInitializeEvent(&pFilter->CaptureStopsDone);
+
 
         NdisZeroMemory(&FilterAttributes, sizeof(NDIS_FILTER_ATTRIBUTES));
         FilterAttributes.Header.Revision = NDIS_FILTER_ATTRIBUTES_REVISION_1;
@@ -368,6 +413,21 @@ N.B.:  FILTER can use NdisRegisterDeviceEx to create a device, so the upper
     {
         if (pFilter != NULL)
         {
+            if (pFilter->DataPathRundown != NULL)
+            {
+                ExFreeCacheAwareRundownProtection(pFilter->DataPathRundown);
+            }
+
+            if (pFilter->CaptureRundown != NULL)
+            {
+                ExFreeCacheAwareRundownProtection(pFilter->CaptureRundown);
+            }
+
+            if (pFilter->CpuCountersBuffer != NULL)
+            {
+                FILTER_FREE_MEM(pFilter->CpuCountersBuffer);
+            }
+
             FILTER_FREE_MEM(pFilter);
         }
     }
@@ -426,6 +486,12 @@ N.B.: When the filter is in Pausing state, it can still process OID requests,
     pFilter->State = FilterPausing;
     FILTER_RELEASE_LOCK(&pFilter->Lock, bFalse);
 
+    //
+    // Stop new send and receive calls from entering the filter and wait for
+    // the ones already inside the send and receive handlers to leave.
+    //
+    ExWaitForRundownProtectionReleaseCacheAware(pFilter->DataPathRundown);
+
     //
     // Do whatever work is required to bring the filter into the Paused state.
     //
@@ -587,8 +653,10 @@ Return Value:
     }
 
     //
-    // If everything is OK, set the filter in running state.
+    // If everything is OK, set the filter in running state and let the
+    // datapath in.
     //
+    ExReInitializeRundownProtectionCacheAware(pFilter->DataPathRundown);
     pFilter->State = FilterRunning; // when successful
 
 
@@ -601,6 +669,7 @@ Return Value:
 
     if (Status != NDIS_STATUS_SUCCESS)
     {
+        ExWaitForRundownProtectionReleaseCacheAware(pFilter->DataPathRundown);
         pFilter->State = FilterPaused;
     }
 
@@ -646,6 +715,12 @@ NOTE: Called at PASSIVE_LEVEL and the filter is in paused state
     //
     FILTER_ASSERT(pFilter->State == FilterPaused);
 
+    //
+    // All the NBLs must have come back by now
+    //
+    FILTER_ASSERT(filterGetOutstandingSends(pFilter) == 0);
+    FILTER_ASSERT(filterGetOutstandingRcvs(pFilter) == 0);
+
 
     //
     // Detach must not fail, so do not put any code here that can possibly fail.
@@ -664,9 +739,18 @@ NOTE: Called at PASSIVE_LEVEL and the filter is in paused state
     RemoveEntryList(&pFilter->FilterModuleLink);
     FILTER_RELEASE_LOCK(&FilterListLock, bFalse);
 
+    //
+    // Now that no new capture can find this filter module, drop any capture
+    // still published to it.
+    //
+    filterDetachCapture(pFilter);
+
 
     //
     // Free the memory allocated
+    ExFreeCacheAwareRundownProtection(pFilter->DataPathRundown);
+    ExFreeCacheAwareRundownProtection(pFilter->CaptureRundown);
+    FILTER_FREE_MEM(pFilter->CpuCountersBuffer);
     FILTER_FREE_MEM(pFilter);
 
     DEBUGP(DL_TRACE, "<===FilterDetach Successfully\n");
@@ -1199,8 +1283,8 @@ Return Value:
 {
     PMS_FILTER         pFilter = (PMS_FILTER)FilterModuleContext;
     ULONG              NumOfSendCompletes = 0;
-    BOOLEAN            DispatchLevel;
     PNET_BUFFER_LIST   CurrNbl;
+    LONG               Ref;
 
     DEBUGP(DL_TRACE, "===>SendNBLComplete, NetBufferList: %p.\n", NetBufferLists);
 
@@ -1228,11 +1312,10 @@ Return Value:
             CurrNbl = NET_BUFFER_LIST_NEXT_NBL(CurrNbl);
 
         }
-        DispatchLevel = NDIS_TEST_SEND_AT_DISPATCH_LEVEL(SendCompleteFlags);
-        FILTER_ACQUIRE_LOCK(&pFilter->Lock, DispatchLevel);
-        pFilter->OutstandingSends -= NumOfSendCompletes;
-        FILTER_LOG_SEND_REF(2, pFilter, PrevNbl, pFilter->OutstandingSends);
-        FILTER_RELEASE_LOCK(&pFilter->Lock, DispatchLevel);
+        Ref = InterlockedAdd(&FILTER_CURRENT_CPU_COUNTERS(pFilter)->OutstandingSends,
+                             -(LONG)NumOfSendCompletes);
+        FILTER_LOG_SEND_REF(2, pFilter, NetBufferLists, Ref);
+        UNREFERENCED_PARAMETER(Ref);
     }
 
     // Send complete the NBLs.  If you removed any NBLs from the chain, make
@@ -1277,6 +1360,10 @@ Arguments:
     PNET_BUFFER_LIST    CurrNbl;
     BOOLEAN             DispatchLevel;
     BOOLEAN             bFalse = FALSE;
+    ULONG               NumOfSends = 0;
+    LONG                Ref;
+    FILTER_NBL_CHAIN    PassChain;
+    FILTER_NBL_CHAIN    DropChain;
 
     DEBUGP(DL_TRACE, "===>SendNetBufferList: NBL = %p.\n", NetBufferLists);
 
@@ -1284,19 +1371,16 @@ Arguments:
     {
 
        DispatchLevel = NDIS_TEST_SEND_AT_DISPATCH_LEVEL(SendFlags);
-#if DBG
-        //
-        // we should never get packets to send if we are not in running state
-        //
 
-        FILTER_ACQUIRE_LOCK(&pFilter->Lock, DispatchLevel);
+        //
+        // we should never get packets to send if we are not in running state.
+        // The rundown reference is cache-aware, so checking it does not
+        // bounce a cache line between the processors sending.
         //
         // If the filter is not in running state, fail the send
         //
-        if (pFilter->State != FilterRunning)
+        if (!ExAcquireRundownProtectionCacheAware(pFilter->DataPathRundown))
         {
-            FILTER_RELEASE_LOCK(&pFilter->Lock, DispatchLevel);
-
             CurrNbl = NetBufferLists;
             while (CurrNbl)
             {
@@ -1309,20 +1393,54 @@ Arguments:
             break;
 
         }
-        FILTER_RELEASE_LOCK(&pFilter->Lock, DispatchLevel);
-#endif
+
+        if (pFilter->Capture != NULL)
+        {
+            filterCaptureNetBufferLists(pFilter, NetBufferLists, FALSE);
+        }
+
+        //
+        // Let the classifier, if there is one, see the whole chain.  Dropped
+        // NBLs are completed straight back up; they were never counted.
+        //
+        if (pFilter->ClassifyHandler != NULL)
+        {
+            filterClassifyChain(pFilter, NetBufferLists, FALSE, &PassChain, &DropChain);
+
+            if (DropChain.Head != NULL)
+            {
+                CurrNbl = DropChain.Head;
+                while (CurrNbl)
+                {
+                    NET_BUFFER_LIST_STATUS(CurrNbl) = NDIS_STATUS_FAILURE;
+                    CurrNbl = NET_BUFFER_LIST_NEXT_NBL(CurrNbl);
+                }
+                NdisFSendNetBufferListsComplete(pFilter->FilterHandle,
+                            DropChain.Head,
+                            DispatchLevel ? NDIS_SEND_COMPLETE_FLAGS_DISPATCH_LEVEL : 0);
+            }
+
+            NetBufferLists = PassChain.Head;
+            if (NetBufferLists == NULL)
+            {
+                ExReleaseRundownProtectionCacheAware(pFilter->DataPathRundown);
+                break;
+            }
+        }
+
         if (pFilter->TrackSends)
         {
-            FILTER_ACQUIRE_LOCK(&pFilter->Lock, DispatchLevel);
             CurrNbl = NetBufferLists;
             while (CurrNbl)
             {
-                pFilter->OutstandingSends++;
-                FILTER_LOG_SEND_REF(1, pFilter, CurrNbl, pFilter->OutstandingSends);
-
+                NumOfSends++;
                 CurrNbl = NET_BUFFER_LIST_NEXT_NBL(CurrNbl);
             }
-            FILTER_RELEASE_LOCK(&pFilter->Lock, DispatchLevel);
+
+            Ref = InterlockedAdd(&FILTER_CURRENT_CPU_COUNTERS(pFilter)->OutstandingSends,
+                                 (LONG)NumOfSends);
+            FILTER_LOG_SEND_REF(1, pFilter, NetBufferLists, Ref);
+            UNREFERENCED_PARAMETER(Ref);
         }
         
         //
@@ -1335,6 +1453,7 @@ Arguments:
         
         NdisFSendNetBufferLists(pFilter->FilterHandle, NetBufferLists, PortNumber, SendFlags);
 
+        ExReleaseRundownProtectionCacheAware(pFilter->DataPathRundown);
 
     }
     while (bFalse);
@@ -1375,8 +1494,7 @@ Arguments:
     PMS_FILTER          pFilter = (PMS_FILTER)FilterModuleContext;
     PNET_BUFFER_LIST    CurrNbl = NetBufferLists;
     UINT                NumOfNetBufferLists = 0;
-    BOOLEAN             DispatchLevel;
-    ULONG               Ref;
+    LONG                Ref;
 
     DEBUGP(DL_TRACE, "===>ReturnNetBufferLists, NetBufferLists is %p.\n", NetBufferLists);
 
@@ -1413,13 +1531,10 @@ Arguments:
 
     if (pFilter->TrackReceives)
     {
-        DispatchLevel = NDIS_TEST_RETURN_AT_DISPATCH_LEVEL(ReturnFlags);
-        FILTER_ACQUIRE_LOCK(&pFilter->Lock, DispatchLevel);
-
-        pFilter->OutstandingRcvs -= NumOfNetBufferLists;
-        Ref = pFilter->OutstandingRcvs;
+        Ref = InterlockedAdd(&FILTER_CURRENT_CPU_COUNTERS(pFilter)->OutstandingRcvs,
+                             -(LONG)NumOfNetBufferLists);
         FILTER_LOG_RCV_REF(3, pFilter, NetBufferLists, Ref);
-        FILTER_RELEASE_LOCK(&pFilter->Lock, DispatchLevel);
+        UNREFERENCED_PARAMETER(Ref);
     }
 
 
@@ -1467,25 +1582,22 @@ N.B.: It is important to check the ReceiveFlags in NDIS_TEST_RECEIVE_CANNOT_PEND
 {
 
     PMS_FILTER          pFilter = (PMS_FILTER)FilterModuleContext;
-    BOOLEAN             DispatchLevel;
-    ULONG               Ref;
+    LONG                Ref;
     BOOLEAN             bFalse = FALSE;
-#if DBG
     ULONG               ReturnFlags;
-#endif
+    FILTER_NBL_CHAIN    PassChain;
+    FILTER_NBL_CHAIN    DropChain;
 
     DEBUGP(DL_TRACE, "===>ReceiveNetBufferList: NetBufferLists = %p.\n", NetBufferLists);
     do
     {
 
-        DispatchLevel = NDIS_TEST_RECEIVE_AT_DISPATCH_LEVEL(ReceiveFlags);
-#if DBG
-        FILTER_ACQUIRE_LOCK(&pFilter->Lock, DispatchLevel);
-
-        if (pFilter->State != FilterRunning)
+        //
+        // As on the send path, check that the filter is running through the
+        // cache-aware rundown reference rather than the filter lock.
+        //
+        if (!ExAcquireRundownProtectionCacheAware(pFilter->DataPathRundown))
         {
-            FILTER_RELEASE_LOCK(&pFilter->Lock, DispatchLevel);
-
             if (NDIS_TEST_RECEIVE_CAN_PEND(ReceiveFlags))
             {
                 ReturnFlags = 0;
@@ -1498,11 +1610,14 @@ N.B.: It is important to check the ReceiveFlags in NDIS_TEST_RECEIVE_CANNOT_PEND
             }
             break;
         }
-        FILTER_RELEASE_LOCK(&pFilter->Lock, DispatchLevel);
-#endif
 
         ASSERT(NumberOfNetBufferLists >= 1);
 
+        if (pFilter->Capture != NULL)
+        {
+            filterCaptureNetBufferLists(pFilter, NetBufferLists, TRUE);
+        }
+
         //
         // If you would like to drop a received packet, then you must carefully
         // modify the NBL chain as follows:
@@ -1541,34 +1656,70 @@ N.B.: It is important to check the ReceiveFlags in NDIS_TEST_RECEIVE_CANNOT_PEND
         // deep copy, and return the original NBL.
         //
 
-        if (pFilter->TrackReceives)
+        //
+        // If a classifier is installed and the chain can be pended, split it
+        // at the verdict boundaries and return the dropped NBLs right away.
+        // A chain that cannot be pended is classified while it is indicated,
+        // see filterIndicateClassified.
+        //
+        if (pFilter->ClassifyHandler != NULL && NDIS_TEST_RECEIVE_CAN_PEND(ReceiveFlags))
         {
-            FILTER_ACQUIRE_LOCK(&pFilter->Lock, DispatchLevel);
-            pFilter->OutstandingRcvs += NumberOfNetBufferLists;
-            Ref = pFilter->OutstandingRcvs;
+            filterClassifyChain(pFilter, NetBufferLists, TRUE, &PassChain, &DropChain);
+
+            if (DropChain.Head != NULL)
+            {
+                ReturnFlags = 0;
+                if (NDIS_TEST_RECEIVE_AT_DISPATCH_LEVEL(ReceiveFlags))
+                {
+                    NDIS_SET_RETURN_FLAG(ReturnFlags, NDIS_RETURN_FLAGS_DISPATCH_LEVEL);
+                }
+
+                NdisFReturnNetBufferLists(pFilter->FilterHandle, DropChain.Head, ReturnFlags);
+            }
 
+            NetBufferLists = PassChain.Head;
+            NumberOfNetBufferLists = PassChain.Count;
+            if (NetBufferLists == NULL)
+            {
+                ExReleaseRundownProtectionCacheAware(pFilter->DataPathRundown);
+                break;
+            }
+        }
+
+        if (pFilter->TrackReceives)
+        {
+            Ref = InterlockedAdd(&FILTER_CURRENT_CPU_COUNTERS(pFilter)->OutstandingRcvs,
+                                 (LONG)NumberOfNetBufferLists);
             FILTER_LOG_RCV_REF(1, pFilter, NetBufferLists, Ref);
-            FILTER_RELEASE_LOCK(&pFilter->Lock, DispatchLevel);
+            UNREFERENCED_PARAMETER(Ref);
         }
 
-        NdisFIndicateReceiveNetBufferLists(
-                   pFilter->FilterHandle,
-                   NetBufferLists,
-                   PortNumber,
-                   NumberOfNetBufferLists,
-                   ReceiveFlags);
+        if (pFilter->ClassifyHandler != NULL && NDIS_TEST_RECEIVE_CANNOT_PEND(ReceiveFlags))
+        {
+            filterIndicateClassified(pFilter, NetBufferLists, PortNumber, ReceiveFlags);
+        }
+        else
+        {
+            NdisFIndicateReceiveNetBufferLists(
+                       pFilter->FilterHandle,
+                       NetBufferLists,
+                       PortNumber,
+                       NumberOfNetBufferLists,
+                       ReceiveFlags);
+        }
 
 
         if (NDIS_TEST_RECEIVE_CANNOT_PEND(ReceiveFlags) &&
             pFilter->TrackReceives)
         {
-            FILTER_ACQUIRE_LOCK(&pFilter->Lock, DispatchLevel);
-            pFilter->OutstandingRcvs -= NumberOfNetBufferLists;
-            Ref = pFilter->OutstandingRcvs;
+            Ref = InterlockedAdd(&FILTER_CURRENT_CPU_COUNTERS(pFilter)->OutstandingRcvs,
+                                 -(LONG)NumberOfNetBufferLists);
             FILTER_LOG_RCV_REF(2, pFilter, NetBufferLists, Ref);
-            FILTER_RELEASE_LOCK(&pFilter->Lock, DispatchLevel);
+            UNREFERENCED_PARAMETER(Ref);
         }
 
+        ExReleaseRundownProtectionCacheAware(pFilter->DataPathRundown);
+
     } while (bFalse);
 
     DEBUGP(DL_TRACE, "<===ReceiveNetBufferList: Flags = %8x.\n", ReceiveFlags);
@@ -1901,3 +2052,71 @@ Return Value:
     NdisSetEvent(&FilterRequest->ReqEvent);
 }
 
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+LONG
+filterGetOutstandingSends(
+    _In_ PMS_FILTER               pFilter
+    )
+/*++
+
+Routine Description:
+
+    Sum the per-processor outstanding send counts.  A send can complete on
+    a different processor than it was sent on, so individual slots can go
+    negative; only the sum is meaningful.
+
+Arguments:
+
+    pFilter - pointer to the filter module context
+
+Return Value:
+
+    The number of NBLs sent down and not yet completed, as of the moment
+    each slot was read.
+
+--*/
+{
+    LONG                         Total = 0;
+    ULONG                        i;
+
+    for (i = 0; i < pFilter->CpuCount; i++)
+    {
+        Total += pFilter->CpuCounters[i].OutstandingSends;
+    }
+
+    return Total;
+}
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+LONG
+filterGetOutstandingRcvs(
+    _In_ PMS_FILTER               pFilter
+    )
+/*++
+
+Routine Description:
+
+    Sum the per-processor outstanding receive counts.
+
+Arguments:
+
+    pFilter - pointer to the filter module context
+
+Return Value:
+
+    The number of NBLs indicated up and not yet returned.
+
+--*/
+{
+    LONG                         Total = 0;
+    ULONG                        i;
+
+    for (i = 0; i < pFilter->CpuCount; i++)
+    {
+        Total += pFilter->CpuCounters[i].OutstandingRcvs;
+    }
+
+    return Total;
+}
+
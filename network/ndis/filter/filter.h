@@ -51,6 +51,7 @@ extern PDEVICE_OBJECT      NdisDeviceObject;
 
 extern FILTER_LOCK         FilterListLock;
 extern LIST_ENTRY          FilterModuleList;
+extern NDIS_MUTEX          FilterCaptureMutex;
 
 
 
@@ -287,6 +288,88 @@ typedef enum _FILTER_STATE
 } FILTER_STATE;
 
 
+//
+// Per-processor datapath counters.  Each processor updates only its own
+// entry, so the send and receive paths never share a cache line.  An NBL
+// may complete on a different processor than it was sent on, so a single
+// entry can go negative; only the sum over all processors is meaningful.
+//
+typedef struct DECLSPEC_CACHEALIGN _FILTER_CPU_COUNTERS
+{
+    volatile LONG                   OutstandingSends;
+    volatile LONG                   OutstandingRcvs;
+} FILTER_CPU_COUNTERS, *PFILTER_CPU_COUNTERS;
+
+#define FILTER_CURRENT_CPU_COUNTERS(_Filter)                                \
+    (&(_Filter)->CpuCounters[KeGetCurrentProcessorNumberEx(NULL) % (_Filter)->CpuCount])
+
+//
+// Packet classification hook.  The classifier is handed up to
+// FILTER_CLASSIFY_BATCH NBLs at a time as one NULL-terminated chain and
+// returns a verdict bitmap: bit i set drops the i-th NBL of the chain.  The
+// filter splits the chain only where the verdict changes, so a batch with
+// a uniform verdict is passed on or dropped without touching its links.
+//
+#define FILTER_CLASSIFY_BATCH       64
+
+typedef
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_Function_class_(FILTER_CLASSIFY_CHAIN)
+ULONG64
+(FILTER_CLASSIFY_CHAIN)(
+    _In_opt_ PVOID                  ClassifyContext,
+    _In_ PNET_BUFFER_LIST           NetBufferLists,
+    _In_ ULONG                      NumberOfNetBufferLists,
+    _In_ BOOLEAN                    Receive
+    );
+
+typedef FILTER_CLASSIFY_CHAIN *PFILTER_CLASSIFY_CHAIN;
+
+typedef struct _FILTER_NBL_CHAIN
+{
+    PNET_BUFFER_LIST                Head;
+    PNET_BUFFER_LIST                Tail;
+    ULONG                           Count;
+} FILTER_NBL_CHAIN, *PFILTER_NBL_CHAIN;
+
+//
+// A packet capture started with IOCTL_FILTER_START_CAPTURE.  The ring is the
+// output buffer of the start IRP, which stays pending until the capture
+// ends.  The capture belongs to the file object it was started on
+// (FsContext) and ends when that handle stops it or is cleaned up, or when
+// the start IRP is cancelled.  FilterCaptureMutex serializes all of these.
+// While it is published in MS_FILTER::Capture the datapath copies packets
+// into it; Filter points back at the filter module and is protected by
+// FilterListLock.
+//
+typedef struct _FILTER_CAPTURE
+{
+    struct _MS_FILTER              *Filter;
+
+    PIRP                            Irp;
+    PFILE_OBJECT                    FileObject;
+    PIO_WORKITEM                    CancelWorkItem;
+
+    PFILTER_CAPTURE_RING_HEADER     Ring;       // system address of the IRP's buffer
+    ULONG                           RingSize;
+
+    ULONG                           FrameCount;
+    ULONG                           FrameSize;
+    ULONG                           SnapLength;
+
+    //
+    // Producer index, never shared with the consumer: producers on
+    // different processors reserve frames by advancing it.
+    //
+    volatile LONG                   ProducerIndex;
+
+    PKEVENT                         Event;
+    ULONG                           WakeupBatch;
+    volatile LONG                   PendingWakeups;
+    KTIMER                          WakeupTimer;
+    KDPC                            WakeupDpc;
+} FILTER_CAPTURE, *PFILTER_CAPTURE;
+
 typedef struct _FILTER_REQUEST
 {
     NDIS_OID_REQUEST       Request;
@@ -312,12 +395,39 @@ typedef struct _MS_FILTER
     NDIS_STATUS                     Status;
     NDIS_EVENT                      Event;
     ULONG                           BackFillSize;
-    FILTER_LOCK                     Lock;    // Lock for protection of state and outstanding sends and recvs
+    FILTER_LOCK                     Lock;    // Lock for protection of state and outstanding requests
 
     FILTER_STATE                    State;   // Which state the filter is in
-    ULONG                           OutstandingSends;
     ULONG                           OutstandingRequest;
-    ULONG                           OutstandingRcvs;
+
+    //
+    // Datapath state.  The send and receive handlers take no lock: they
+    // count NBLs in per-processor counters, and they check that the filter
+    // is running by acquiring the cache-aware rundown reference, which is
+    // run down while the filter is paused.
+    //
+    PFILTER_CPU_COUNTERS            CpuCounters;
+    PVOID                           CpuCountersBuffer;
+    ULONG                           CpuCount;
+    PEX_RUNDOWN_REF_CACHE_AWARE     DataPathRundown;
+
+    //
+    // Optional classifier, see filterSetClassifyHandler.  NULL passes
+    // every NBL through untouched.
+    //
+    PFILTER_CLASSIFY_CHAIN          ClassifyHandler;
+    PVOID                           ClassifyContext;
+
+    //
+    // Packet capture, see capture.c.  The datapath holds CaptureRundown
+    // while it uses Capture; stopping a capture unpublishes it and waits
+    // for that reference to drain.  CaptureStops counts stops that are
+    // still waiting, and FilterDetach waits on CaptureStopsDone for them.
+    //
+    PFILTER_CAPTURE                 Capture;
+    PEX_RUNDOWN_REF_CACHE_AWARE     CaptureRundown;
+    ULONG                           CaptureStops;
+    NDIS_EVENT                      CaptureStopsDone;
     FILTER_LOCK                     SendLock;
     FILTER_LOCK                     RcvLock;
     QUEUE_HEADER                    SendNBLQueue;
@@ -421,6 +531,18 @@ DRIVER_DISPATCH FilterDispatch;
 
 DRIVER_DISPATCH FilterDeviceIoControl;
 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+LONG
+filterGetOutstandingSends(
+    _In_ PMS_FILTER                   pFilter
+    );
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+LONG
+filterGetOutstandingRcvs(
+    _In_ PMS_FILTER                   pFilter
+    );
+
 _IRQL_requires_max_(DISPATCH_LEVEL)
 PMS_FILTER
 filterFindFilterModule(
@@ -450,6 +572,61 @@ filterInternalRequestComplete(
     _In_ NDIS_STATUS                  Status
     );
 
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+filterStartCapture(
+    _In_ PDEVICE_OBJECT               DeviceObject,
+    _In_ PIRP                         Irp,
+    _In_ PFILTER_START_CAPTURE        StartCapture
+    );
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+filterStopCapture(
+    _In_ PFILE_OBJECT                 FileObject
+    );
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+filterDetachCapture(
+    _In_ PMS_FILTER                   pFilter
+    );
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+filterCaptureNetBufferLists(
+    _In_ PMS_FILTER                   pFilter,
+    _In_ PNET_BUFFER_LIST             NetBufferLists,
+    _In_ BOOLEAN                      Receive
+    );
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+filterSetClassifyHandler(
+    _In_ PMS_FILTER                   pFilter,
+    _In_opt_ PFILTER_CLASSIFY_CHAIN   ClassifyHandler,
+    _In_opt_ PVOID                    ClassifyContext
+    );
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+filterClassifyChain(
+    _In_ PMS_FILTER                   pFilter,
+    _In_ PNET_BUFFER_LIST             NetBufferLists,
+    _In_ BOOLEAN                      Receive,
+    _Out_ PFILTER_NBL_CHAIN           PassChain,
+    _Out_ PFILTER_NBL_CHAIN           DropChain
+    );
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+filterIndicateClassified(
+    _In_ PMS_FILTER                   pFilter,
+    _In_ PNET_BUFFER_LIST             NetBufferLists,
+    _In_ NDIS_PORT_NUMBER             PortNumber,
+    _In_ ULONG                        ReceiveFlags
+    );
+
 
 #endif  //_FILT_H
 
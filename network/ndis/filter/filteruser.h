@@ -25,6 +25,8 @@
 #define IOCTL_FILTER_WRITE_ADAPTER_CONFIG   _NDIS_CONTROL_CODE(11, METHOD_BUFFERED)
 #define IOCTL_FILTER_READ_INSTANCE_CONFIG   _NDIS_CONTROL_CODE(12, METHOD_BUFFERED)
 #define IOCTL_FILTER_WRITE_INSTANCE_CONFIG  _NDIS_CONTROL_CODE(13, METHOD_BUFFERED)
+#define IOCTL_FILTER_START_CAPTURE          _NDIS_CONTROL_CODE(14, METHOD_OUT_DIRECT)
+#define IOCTL_FILTER_STOP_CAPTURE           _NDIS_CONTROL_CODE(15, METHOD_BUFFERED)
 
 
 #define MAX_FILTER_INSTANCE_NAME_LENGTH     256
@@ -85,5 +87,92 @@ typedef struct _FILTER_WRITE_CONFIG
     UCHAR                   Data[sizeof(ULONG)];
 }FILTER_WRITE_CONFIG, *PFILTER_WRITE_CONFIG;
 
+//
+// Packet capture.
+//
+// IOCTL_FILTER_START_CAPTURE lays a ring of fixed-size frame slots out in
+// its output buffer and starts copying the first SnapLength bytes of every
+// packet sent or received on the named filter instance into it.  The buffer
+// must hold FILTER_CAPTURE_RING_SIZE(SnapLength, FrameCount) bytes and be
+// aligned to FILTER_CAPTURE_FRAME_ALIGNMENT.  The driver keeps the request
+// pending while the capture runs, so the handle must be opened for
+// overlapped I/O.  The capture ends, and the request completes, when
+// IOCTL_FILTER_STOP_CAPTURE is issued on the same handle, the handle is
+// closed, or the request is cancelled.  The buffer belongs to the driver
+// until the request has completed.  Only one capture can run on a filter
+// instance at a time, and only one per handle.
+//
+// The ring starts with a FILTER_CAPTURE_RING_HEADER; frame i is at
+// HeaderSize + (i & (FrameCount - 1)) * FrameSize from the start of the ring.
+// The driver sets Status to FILTER_CAPTURE_FRAME_READY once a frame is
+// complete.  The consumer processes the frame at ConsumerIndex while it is
+// ready, sets its Status back to FILTER_CAPTURE_FRAME_FREE, and then
+// increments ConsumerIndex.  A packet that finds the ring full is counted
+// in DroppedFrames and not captured.
+//
+// The event, if one is given, is signaled once WakeupBatch frames have been
+// captured since the last wakeup, and at least every
+// FILTER_CAPTURE_WAKEUP_INTERVAL_MS while frames are trickling in.
+//
+#define FILTER_CAPTURE_MIN_FRAMES           16
+#define FILTER_CAPTURE_MAX_FRAMES           65536
+#define FILTER_CAPTURE_MAX_SNAPLENGTH       9216
+#define FILTER_CAPTURE_MAX_RING_SIZE        (16 * 1024 * 1024)
+#define FILTER_CAPTURE_FRAME_ALIGNMENT      16
+#define FILTER_CAPTURE_WAKEUP_INTERVAL_MS   10
+
+#define FILTER_CAPTURE_FRAME_FREE           0
+#define FILTER_CAPTURE_FRAME_READY          1
+
+#define FILTER_CAPTURE_FRAME_RECEIVE        0x00000001  // otherwise a send
+#define FILTER_CAPTURE_FRAME_TRUNCATED      0x00000002  // OriginalLength > CapturedLength
+
+#define FILTER_CAPTURE_FRAME_SIZE(_SnapLength)                              \
+    ((FIELD_OFFSET(FILTER_CAPTURE_FRAME, Data) + (_SnapLength) +            \
+      FILTER_CAPTURE_FRAME_ALIGNMENT - 1) & ~(FILTER_CAPTURE_FRAME_ALIGNMENT - 1))
+
+#define FILTER_CAPTURE_RING_SIZE(_SnapLength, _FrameCount)                  \
+    (sizeof(FILTER_CAPTURE_RING_HEADER) +                                   \
+     (ULONG64)FILTER_CAPTURE_FRAME_SIZE(_SnapLength) * (_FrameCount))
+
+typedef struct _FILTER_START_CAPTURE
+{
+    WCHAR           InstanceName[MAX_FILTER_INSTANCE_NAME_LENGTH];
+    ULONG           InstanceNameLength;
+    ULONG           SnapLength;         // bytes copied from the front of each packet
+    ULONG           FrameCount;         // a power of two
+    ULONG           WakeupBatch;        // frames per wakeup; 0 means FrameCount / 4
+    ULONG64         EventHandle;        // optional
+} FILTER_START_CAPTURE, *PFILTER_START_CAPTURE;
+
+typedef struct _FILTER_CAPTURE_RING_HEADER
+{
+    //
+    // Written by the driver
+    //
+    ULONG           HeaderSize;
+    ULONG           FrameSize;
+    ULONG           FrameCount;
+    ULONG           SnapLength;
+    volatile LONG64 DroppedFrames;
+    UCHAR           Reserved[40];
+
+    //
+    // Written by the consumer, on a cache line of its own
+    //
+    volatile ULONG  ConsumerIndex;
+    UCHAR           Reserved2[60];
+} FILTER_CAPTURE_RING_HEADER, *PFILTER_CAPTURE_RING_HEADER;
+
+typedef struct _FILTER_CAPTURE_FRAME
+{
+    volatile LONG   Status;
+    ULONG           Flags;
+    ULONG           OriginalLength;
+    ULONG           CapturedLength;
+    ULONG64         Timestamp;          // interrupt time, in 100ns units
+    UCHAR           Data[1];
+} FILTER_CAPTURE_FRAME, *PFILTER_CAPTURE_FRAME;
+
 #endif //__FILTERUSER_H__
 
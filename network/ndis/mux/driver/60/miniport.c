@@ -237,6 +237,14 @@ Return Value:
             MPGenerateMacAddr(pVElan);
         }
 
+        //
+        // The VELAN was hashed by its initial address when it was
+        // linked to the adapter.
+        //
+        MUX_ACQUIRE_ADAPT_WRITE_LOCK(pVElan->pAdapt, &LockState);
+        PtRebuildVElanTable(pVElan->pAdapt);
+        MUX_RELEASE_ADAPT_WRITE_LOCK(pVElan->pAdapt, &LockState);
+
         //
         // ignore error reading the network address
         //
@@ -1589,6 +1597,7 @@ Return Value:
         // Save the new packet filter value
         //
         pVElan->PacketFilter = PacketFilter;
+        PtRebuildVElanTable(pAdapt);
 
         //
         // Compute the new combined filter for all VELANs on this
@@ -2386,6 +2395,127 @@ NOTE: This function always returns NULL. This is so that MUX can allocate memory
     return NULL;
 }
 
+VOID
+MPAllocateTagHeaderPool(
+    IN PVELAN           pVElan
+    )
+/*++
+
+Routine Description:
+    Preallocate the VELAN's tag headers and their MDLs. If this fails the
+    pool is left empty, and tagged sends allocate from TagLookaside.
+    pVElan->pAdapt and pVElan->BindingHandle must be set.
+
+Arguments:
+    pVElan                          Pointer to VELAN structure
+
+Return Value:
+    None
+
+--*/
+{
+    PIM_SEND_NB_ENTRY       pEntry;
+    PUCHAR                  pHeader;
+    ULONG                   i;
+
+    InitializeSListHead(&pVElan->TagHeaderPool);
+
+    //
+    // Frames are never retagged if the miniport below does the tagging.
+    //
+    if (MUX_ADAPT_OFFLOADS_VLAN_TAGGING(pVElan->pAdapt))
+    {
+        return;
+    }
+
+    pVElan->TagHeaderPoolMemory = NdisAllocateMemoryWithTagPriority(pVElan->BindingHandle,
+                                                                    MUX_TAG_HEADER_POOL_SIZE * MUX_TAG_HEADER_ENTRY_SIZE,
+                                                                    MUX_TAG,
+                                                                    NormalPoolPriority);
+    if (pVElan->TagHeaderPoolMemory == NULL)
+    {
+        return;
+    }
+
+    NdisZeroMemory(pVElan->TagHeaderPoolMemory,
+                   MUX_TAG_HEADER_POOL_SIZE * MUX_TAG_HEADER_ENTRY_SIZE);
+
+    for (i = 0; i < MUX_TAG_HEADER_POOL_SIZE; i++)
+    {
+        pEntry = (PIM_SEND_NB_ENTRY)((PUCHAR)pVElan->TagHeaderPoolMemory + i * MUX_TAG_HEADER_ENTRY_SIZE);
+        pHeader = (PUCHAR)pEntry + sizeof(IM_SEND_NB_ENTRY);
+
+        pEntry->HeaderMdl = IoAllocateMdl(pHeader,
+                                          ETH_HEADER_SIZE + VLAN_TAG_HEADER_SIZE,
+                                          FALSE,
+                                          FALSE,
+                                          NULL);
+
+        //
+        // The data MDL is rebuilt with IoBuildPartialMdl on each use, it
+        // only needs to be large enough.
+        //
+        pEntry->DataMdl = IoAllocateMdl(PAGE_ALIGN(pHeader),
+                                        MUX_TAG_DATA_MDL_PAGES * PAGE_SIZE,
+                                        FALSE,
+                                        FALSE,
+                                        NULL);
+
+        if ((pEntry->HeaderMdl == NULL) || (pEntry->DataMdl == NULL))
+        {
+            break;
+        }
+
+        MmBuildMdlForNonPagedPool(pEntry->HeaderMdl);
+
+        InterlockedPushEntrySList(&pVElan->TagHeaderPool, &pEntry->PoolLink);
+    }
+}
+
+VOID
+MPFreeTagHeaderPool(
+    IN PVELAN           pVElan
+    )
+/*++
+
+Routine Description:
+    Free the VELAN's tag headers. All sends on the VELAN must have completed.
+
+Arguments:
+    pVElan                          Pointer to VELAN structure
+
+Return Value:
+    None
+
+--*/
+{
+    PIM_SEND_NB_ENTRY       pEntry;
+    ULONG                   i;
+
+    if (pVElan->TagHeaderPoolMemory == NULL)
+    {
+        return;
+    }
+
+    for (i = 0; i < MUX_TAG_HEADER_POOL_SIZE; i++)
+    {
+        pEntry = (PIM_SEND_NB_ENTRY)((PUCHAR)pVElan->TagHeaderPoolMemory + i * MUX_TAG_HEADER_ENTRY_SIZE);
+
+        if (pEntry->HeaderMdl != NULL)
+        {
+            IoFreeMdl(pEntry->HeaderMdl);
+        }
+
+        if (pEntry->DataMdl != NULL)
+        {
+            IoFreeMdl(pEntry->DataMdl);
+        }
+    }
+
+    NdisFreeMemory(pVElan->TagHeaderPoolMemory, 0, 0);
+    pVElan->TagHeaderPoolMemory = NULL;
+}
+
 NDIS_STATUS 
 MPHandleSendTaggingNB(
     IN PVELAN pVElan,
@@ -2405,8 +2535,10 @@ Return Value:
     NDIS_STATUS_SUCCESS
     NDIS_STATUS_XXX
 
-NOTE: This functio doesn't handle vlan tagging in an efficient way, please wait for the next release
-      to get a better implementation.
+NOTE: If the miniport below does 802.1Q tagging itself, the VLAN ID is only set
+      in the NBL's Ieee8021QNetBufferListInfo. Otherwise the tag is inserted into
+      each frame, using a header from the VELAN's TagHeaderPool if the frame has
+      no room in front of its data.
 
 --*/
 {
@@ -2423,6 +2555,9 @@ NOTE: This functio doesn't handle vlan tagging in an efficient way, please wait
     PMDL                    Mdl, FirstMdl, SecondMdl, PrevMdl;
     ULONG                   BytesToSkip;
     ULONG                   BufferLength;  
+    ULONG                   DataOffset = 0;
+    PUCHAR                  pDataVa;
+    PSLIST_ENTRY            pPoolEntry;
     PVOID                   Storage;
     PNET_BUFFER             MdlAllocatedNetBuffers = NULL;
 
@@ -2469,6 +2604,24 @@ NOTE: This functio doesn't handle vlan tagging in an efficient way, please wait
             break;
         }
 
+        //
+        // If the miniport below inserts the tag itself, pass the VLAN ID
+        // down in the out-of-band information and leave the frames alone.
+        //
+        if (MUX_ADAPT_OFFLOADS_VLAN_TAGGING(pVElan->pAdapt))
+        {
+            SendContext->Original8021qInfo = NET_BUFFER_LIST_INFO(NetBufferList, Ieee8021QNetBufferListInfo);
+
+            if (NdisPacket8021qInfo.TagHeader.VlanId == 0)
+            {
+                NdisPacket8021qInfo.TagHeader.VlanId = pVElan->VlanId;
+            }
+
+            NET_BUFFER_LIST_INFO(NetBufferList, Ieee8021QNetBufferListInfo) = NdisPacket8021qInfo.Value;
+            SendContext->Flags |= MUX_TAG_OFFLOADED;
+            break;
+        }
+
         CurrentNetBuffer = NET_BUFFER_LIST_FIRST_NB(NetBufferList);
         LastNetBufferContext = NULL;
 
@@ -2550,6 +2703,8 @@ NOTE: This functio doesn't handle vlan tagging in an efficient way, please wait
                             break;
                         }
 
+                        DataOffset = BytesToSkip;
+
                         //
                         // Have we gone far enough into the packet?
                         // 
@@ -2584,56 +2739,84 @@ NOTE: This functio doesn't handle vlan tagging in an efficient way, please wait
                     }
 
                     //
-                    // AllocateSpace for Ethernet + VLAN tag header + Netbuffer context
+                    // Take a preallocated header if its data MDL can describe the
+                    // rest of this buffer. The data MDL is built as a partial MDL
+                    // of the buffer's own MDL.
                     //
-                    pNetBufferContext = (PIM_SEND_NB_ENTRY) NdisAllocateFromNPagedLookasideList(&pVElan->TagLookaside);
+                    pDataVa = (PUCHAR)MmGetMdlVirtualAddress(Mdl) + DataOffset;
+                    pPoolEntry = NULL;
 
-                    //
-                    // Memory allocation failed
-                    //
-                    if (pNetBufferContext == NULL)
+                    if (ADDRESS_AND_SIZE_TO_SPAN_PAGES(pDataVa, BufferLength) <= MUX_TAG_DATA_MDL_PAGES)
                     {
-                        Status = NDIS_STATUS_RESOURCES;
-                        break;
+                        pPoolEntry = InterlockedPopEntrySList(&pVElan->TagHeaderPool);
                     }
 
-                    NdisZeroMemory((PVOID)pNetBufferContext, sizeof(IM_SEND_NB_ENTRY));
-                    
-                    pEthFrameNew = ((PUCHAR) pNetBufferContext) + sizeof(IM_SEND_NB_ENTRY);
+                    if (pPoolEntry != NULL)
+                    {
+                        pNetBufferContext = CONTAINING_RECORD(pPoolEntry, IM_SEND_NB_ENTRY, PoolLink);
 
-                    //
-                    // Allocate MDLs for the Ethernet + VLAN tag header and
-                    // the data that follow these.
-                    //
-                    SecondMdl = NdisAllocateMdl(pVElan->MiniportAdapterHandle,
-                                                pVa,    // byte following the Eth+tag headers
-                                                BufferLength);
-                    
-                    FirstMdl = NdisAllocateMdl(pVElan->MiniportAdapterHandle,
-                                               pEthFrameNew,
-                                               ETH_HEADER_SIZE + VLAN_TAG_HEADER_SIZE);
+                        FirstMdl = pNetBufferContext->HeaderMdl;
+                        SecondMdl = pNetBufferContext->DataMdl;
 
-                    if (!FirstMdl || !SecondMdl)
+                        IoBuildPartialMdl(Mdl, SecondMdl, pDataVa, BufferLength);
+                    }
+                    else
                     {
                         //
-                        // One of the buffer allocations failed
+                        // AllocateSpace for Ethernet + VLAN tag header + Netbuffer context
                         //
-                        if (FirstMdl)
-                        {
-                            NdisFreeMdl(FirstMdl);
-                        }
+                        pNetBufferContext = (PIM_SEND_NB_ENTRY) NdisAllocateFromNPagedLookasideList(&pVElan->TagLookaside);
 
-                        if (SecondMdl)
+                        //
+                        // Memory allocation failed
+                        //
+                        if (pNetBufferContext == NULL)
                         {
-                            NdisFreeMdl(SecondMdl);
+                            Status = NDIS_STATUS_RESOURCES;
+                            break;
                         }
 
-                        NdisFreeToNPagedLookasideList(&pVElan->TagLookaside, (PVOID) pNetBufferContext);
+                        NdisZeroMemory((PVOID)pNetBufferContext, sizeof(IM_SEND_NB_ENTRY));
 
-                        Status = NDIS_STATUS_RESOURCES;
-                        break;
+                        //
+                        // Allocate MDLs for the Ethernet + VLAN tag header and
+                        // the data that follow these.
+                        //
+                        SecondMdl = NdisAllocateMdl(pVElan->MiniportAdapterHandle,
+                                                    pVa,    // byte following the Eth+tag headers
+                                                    BufferLength);
+                        
+                        FirstMdl = NdisAllocateMdl(pVElan->MiniportAdapterHandle,
+                                                   ((PUCHAR) pNetBufferContext) + sizeof(IM_SEND_NB_ENTRY),
+                                                   ETH_HEADER_SIZE + VLAN_TAG_HEADER_SIZE);
+
+                        if (!FirstMdl || !SecondMdl)
+                        {
+                            //
+                            // One of the buffer allocations failed
+                            //
+                            if (FirstMdl)
+                            {
+                                NdisFreeMdl(FirstMdl);
+                            }
+
+                            if (SecondMdl)
+                            {
+                                NdisFreeMdl(SecondMdl);
+                            }
+
+                            NdisFreeToNPagedLookasideList(&pVElan->TagLookaside, (PVOID) pNetBufferContext);
+
+                            Status = NDIS_STATUS_RESOURCES;
+                            break;
+                        }
                     }
+
+                    pNetBufferContext->PrevMdl = NULL;
+                    pNetBufferContext->NextNetBuffer = NULL;
                     
+                    pEthFrameNew = ((PUCHAR) pNetBufferContext) + sizeof(IM_SEND_NB_ENTRY);
+
                     //
                     // All allocations are successful. 
                     // Copy the Ethernet header to the newly allocated memory
@@ -2895,13 +3078,23 @@ Return Value:
                 CurrentMdlAllocatedNetBuffer = NetBufferContext->NextNetBuffer;                   
 
                 //
-                // Free the MDLs and the memory allocated
+                // Return a preallocated header to the pool, or free the
+                // MDLs and the memory allocated
                 //
-                NdisFreeMdl(SecondMdl);        
+                if (NetBufferContext->HeaderMdl != NULL)
+                {
+                    MmPrepareMdlForReuse(SecondMdl);
 
-                NdisFreeMdl(FirstMdl);
+                    InterlockedPushEntrySList(&pVElan->TagHeaderPool, &NetBufferContext->PoolLink);
+                }
+                else
+                {
+                    NdisFreeMdl(SecondMdl);        
+
+                    NdisFreeMdl(FirstMdl);
 
-                NdisFreeToNPagedLookasideList(&pVElan->TagLookaside, (PVOID) NetBufferContext);          
+                    NdisFreeToNPagedLookasideList(&pVElan->TagLookaside, (PVOID) NetBufferContext);          
+                }
             }
         }
 
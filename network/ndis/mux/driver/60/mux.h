@@ -129,6 +129,23 @@ VOID
 #define MIN_PACKET_POOL_SIZE            255
 #define MAX_PACKET_POOL_SIZE            4096
 
+//
+// Number of buckets in the per-adapter table of VELANs indexed by
+// MAC address, used to demultiplex directed receives. Must be a
+// power of 2.
+//
+#define MUX_VELAN_HASH_TABLE_SIZE       64
+
+#define MUX_HASH_MAC_ADDRESS(_pMac)                                  \
+            (((_pMac)[3] ^ (_pMac)[4] ^ ((_pMac)[5] * 7)) &          \
+             (MUX_VELAN_HASH_TABLE_SIZE - 1))
+
+//
+// Number of VELANs that PtReceiveNBL builds receive chains for before
+// it indicates them.
+//
+#define MUX_MAX_RECEIVE_BATCHES         4
+
 typedef UCHAR   MUX_MAC_ADDRESS[6];
 
 
@@ -272,6 +289,19 @@ PtFindVElan(
     IN    PNDIS_STRING              pElanKey
     );
 
+VOID
+PtRebuildVElanTable(
+    IN    PADAPT                    pAdapt
+    );
+
+BOOLEAN
+PtLookupVElan(
+    IN    PADAPT                    pAdapt,
+    IN    PUCHAR                    pDstMac,
+    IN    ULONG                     VlanId,
+    OUT   PVELAN *                  ppVElan
+    );
+
 
 NDIS_STATUS
 PtBootStrapVElans(
@@ -442,6 +472,15 @@ typedef struct _ADAPT
     // Length of above list.
     ULONG                       VElanCount;
 
+    //
+    // VELANs hashed by current MAC address, and the number of VELANs
+    // whose packet filter is promiscuous. Used to find the VELAN a
+    // directed receive belongs to without walking the VELAN list.
+    // Rebuilt by PtRebuildVElanTable with the write lock held.
+    //
+    PVELAN                      VElanHashTable[MUX_VELAN_HASH_TABLE_SIZE];
+    ULONG                       PromiscuousVElanCount;
+
     // String used to access configuration for this binding.
     NDIS_STRING                 ConfigString;
 
@@ -509,6 +548,9 @@ typedef struct _VELAN
     // Link into parent adapter's VELAN list.
     LIST_ENTRY                  Link;
 
+    // Next VELAN in the same bucket of the parent's VElanHashTable.
+    struct _VELAN *             pNextHash;
+
     // link inot global VELAN list
     LIST_ENTRY                  GlobalLink;
 
@@ -627,11 +669,32 @@ typedef struct _VELAN
     ULONG                       RcvVlanIdErrors;
     BOOLEAN                     RestoreLookaheadSize;
     NPAGED_LOOKASIDE_LIST       TagLookaside;    
+
+    //
+    // Tag headers (IM_SEND_NB_ENTRY followed by the Ethernet and VLAN
+    // tag header) with prebuilt MDLs, so that tagged sends that need
+    // a new header do not allocate. Allocated as one block in
+    // TagHeaderPoolMemory; TagLookaside is used when the pool is empty.
+    //
+    SLIST_HEADER                TagHeaderPool;
+    PVOID                       TagHeaderPoolMemory;
 #endif
 
     NET_IFINDEX                 IfIndex;
 } VELAN, *PVELAN;
 
+//
+// A chain of received NBLs that PtReceiveNBL has matched to one VELAN
+// and will indicate to it in a single call.
+//
+typedef struct _MUX_RECEIVE_BATCH
+{
+    PVELAN                      pVElan;
+    PNET_BUFFER_LIST            Head;
+    PNET_BUFFER_LIST            Tail;
+    ULONG                       Count;
+} MUX_RECEIVE_BATCH, *PMUX_RECEIVE_BATCH;
+
 
 #define MUX_ACQUIRE_SPIN_LOCK(_pLock, DispatchLevel)     \
     {                                                    \
@@ -736,6 +799,7 @@ typedef struct _VLAN_TAG_HEADER
 // Flags used by VELAN supports
 //
 #define MUX_RETREAT_DATA          0x00000001
+#define MUX_TAG_OFFLOADED         0x00000002
 
 //
 // Flags used by VELAN on Receive code path
@@ -762,12 +826,39 @@ typedef struct _RECV_NBL_ENTRY
 //
 typedef struct _IM_SEND_NB_ENTRY
 {
+    SLIST_ENTRY     PoolLink;
     PMDL            CurrentMdl;
     PMDL            PrevMdl;
     ULONG           CurrentMdlOffset;
     PNET_BUFFER     NextNetBuffer;
+
+    //
+    // Only set for entries from the VELAN's TagHeaderPool: the MDL that
+    // describes the header that follows this structure, and the MDL
+    // that is rebuilt over the rest of the original buffer on each use.
+    //
+    PMDL            HeaderMdl;
+    PMDL            DataMdl;
 } IM_SEND_NB_ENTRY, *PIM_SEND_NB_ENTRY;
 
+//
+// Number of preallocated tag headers per VELAN, and the number of pages
+// the data MDL of each can describe.
+//
+#define MUX_TAG_HEADER_POOL_SIZE        64
+#define MUX_TAG_DATA_MDL_PAGES          17
+
+#define MUX_TAG_HEADER_ENTRY_SIZE                                       \
+            ALIGN_UP_BY(sizeof(IM_SEND_NB_ENTRY) + ETH_HEADER_SIZE +    \
+                        VLAN_TAG_HEADER_SIZE, MEMORY_ALLOCATION_ALIGNMENT)
+
+//
+// Does the miniport below insert 802.1Q headers itself from the
+// Ieee8021QNetBufferListInfo of each send?
+//
+#define MUX_ADAPT_OFFLOADS_VLAN_TAGGING(_pAdapt)                        \
+            (((_pAdapt)->BindParameters.MacOptions & NDIS_MAC_OPTION_8021Q_VLAN) != 0)
+
 #endif //IEEE_VLAN_SUPPORT
 
 typedef struct _IM_NBL_ENTRY 
@@ -777,6 +868,7 @@ typedef struct _IM_NBL_ENTRY
 #if IEEE_VLAN_SUPPORT    
     ULONG        Flags;
     PNET_BUFFER  MdlAllocatedNetBuffers;
+    PVOID        Original8021qInfo;
 #endif
     DECLSPEC_ALIGN(MEMORY_ALLOCATION_ALIGNMENT)
     UCHAR        Pad[];
@@ -912,6 +1004,16 @@ MuxAllocateMdl(
     IN OUT PULONG               BufferSize
     );
 
+VOID
+MPAllocateTagHeaderPool(
+    IN PVELAN           pVElan
+    );
+
+VOID
+MPFreeTagHeaderPool(
+    IN PVELAN           pVElan
+    );
+
 NDIS_STATUS 
 MPHandleSendTaggingNB(
     IN PVELAN           pVElan,
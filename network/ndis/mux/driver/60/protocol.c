@@ -1458,6 +1458,136 @@ Return Value:
 }
 
 
+VOID
+PtRebuildVElanTable(
+    IN PADAPT                       pAdapt
+    )
+/*++
+
+Routine Description:
+
+    Rebuild the table of the adapter's VELANs indexed by MAC
+    address, and recount the VELANs in promiscuous mode. This
+    must be called whenever a VELAN is linked to or unlinked from
+    the adapter, or a VELAN's address or packet filter changes.
+
+    NOTE: the caller is assumed to hold a WRITE lock
+    to the ADAPT structure.
+
+Arguments:
+
+    pAdapt  - Adapter whose table to rebuild
+
+Return Value:
+
+    None
+
+--*/
+{
+    PLIST_ENTRY     p;
+    PVELAN          pVElan;
+    ULONG           Bucket;
+
+    NdisZeroMemory(pAdapt->VElanHashTable, sizeof(pAdapt->VElanHashTable));
+    pAdapt->PromiscuousVElanCount = 0;
+
+    for (p = pAdapt->VElanList.Flink;
+         p != &pAdapt->VElanList;
+         p = p->Flink)
+    {
+        pVElan = CONTAINING_RECORD(p, VELAN, Link);
+
+        Bucket = MUX_HASH_MAC_ADDRESS(pVElan->CurrentAddress);
+        pVElan->pNextHash = pAdapt->VElanHashTable[Bucket];
+        pAdapt->VElanHashTable[Bucket] = pVElan;
+
+        if (pVElan->PacketFilter & NDIS_PACKET_TYPE_PROMISCUOUS)
+        {
+            pAdapt->PromiscuousVElanCount++;
+        }
+    }
+}
+
+
+BOOLEAN
+PtLookupVElan(
+    IN PADAPT                       pAdapt,
+    IN PUCHAR                       pDstMac,
+    IN ULONG                        VlanId,
+    OUT PVELAN *                    ppVElan
+    )
+/*++
+
+Routine Description:
+
+    Find the VELAN that a directed packet with the given destination
+    address and VLAN ID belongs to.
+
+    NOTE: the caller is assumed to hold a READ/WRITE lock
+    to the ADAPT structure, and to have checked that no VELAN
+    is in promiscuous mode.
+
+Arguments:
+
+    pAdapt  - Adapter the packet was received on
+    pDstMac - Destination MAC address in received packet
+    VlanId  - VLAN ID in received packet, 0 if untagged
+    ppVElan - Receives the matching VELAN, or NULL if there is none
+
+Return Value:
+
+    FALSE if more than one VELAN uses the address on this VLAN, in
+    which case the caller must check every VELAN. TRUE otherwise.
+
+--*/
+{
+    PVELAN          pVElan;
+    UINT            AddrCompareResult;
+
+#if !IEEE_VLAN_SUPPORT
+    UNREFERENCED_PARAMETER(VlanId);
+#endif
+
+    *ppVElan = NULL;
+
+    for (pVElan = pAdapt->VElanHashTable[MUX_HASH_MAC_ADDRESS(pDstMac)];
+         pVElan != NULL;
+         pVElan = pVElan->pNextHash)
+    {
+        ETH_COMPARE_NETWORK_ADDRESSES_EQ(pVElan->CurrentAddress,
+                                         pDstMac,
+                                         &AddrCompareResult);
+        if (AddrCompareResult != 0)
+        {
+            continue;
+        }
+
+#if IEEE_VLAN_SUPPORT
+        //
+        // Same test as PtHandleReceiveTaggingNB: a VELAN with VLAN ID 0,
+        // or a packet without a VLAN ID, matches any VLAN.
+        //
+        if ((VlanId != 0) &&
+            !MuxRecognizedVlanId(pVElan, 0) &&
+            !MuxRecognizedVlanId(pVElan, VlanId))
+        {
+            continue;
+        }
+#endif
+
+        if (*ppVElan != NULL)
+        {
+            *ppVElan = NULL;
+            return FALSE;
+        }
+
+        *ppVElan = pVElan;
+    }
+
+    return TRUE;
+}
+
+
 NDIS_STATUS
 PtPnPNetEventSetPower(
     IN PADAPT                       pAdapt,
@@ -1972,6 +2102,8 @@ Return Value:
                 MUX_TAG,
                 0);
 
+        MPAllocateTagHeaderPool(pVElan);
+
 #endif
         //
         // Finally link this VELAN to the Adapter's VELAN list. 
@@ -1985,6 +2117,7 @@ Return Value:
 
         pAdapt->VElanCount++;
         pVElan->VElanNumber = NdisInterlockedIncrement((PLONG)&NextVElanNumber);
+        PtRebuildVElanTable(pAdapt);
 
         MUX_RELEASE_ADAPT_WRITE_LOCK(pAdapt, &LockState);
 
@@ -2034,6 +2167,7 @@ Return Value:
     NdisFreeSpinLock(&pVElan->PauseLock);
 
 #ifdef IEEE_VLAN_SUPPORT
+    MPFreeTagHeaderPool(pVElan);
     NdisDeleteNPagedLookasideList(&pVElan->TagLookaside);    
 #endif
 
@@ -2210,6 +2344,7 @@ Return Value:
 
     RemoveEntryList(&pVElan->Link);
     pAdapt->VElanCount--;
+    PtRebuildVElanTable(pAdapt);
         
     MUX_RELEASE_ADAPT_WRITE_LOCK(pAdapt, &LockState);
     pVElan->pAdapt = NULL;
@@ -2631,6 +2766,109 @@ Return Value:
 }
 
 
+static
+VOID
+PtIndicateReceiveBatches(
+    IN PMUX_RECEIVE_BATCH           Batches,
+    IN OUT PULONG                   pNumBatches,
+    IN NDIS_PORT_NUMBER             PortNumber,
+    IN ULONG                        ReceiveFlags
+    )
+/*++
+
+Routine Description:
+
+    Indicate each receive chain built by PtReceiveNBL up on its VELAN,
+    and empty the batch array. Each NBL in the chains holds a pending
+    receive on its VELAN, which MPReturnNetBufferLists releases.
+
+Arguments:
+
+    Batches     - Receive chains to indicate
+    pNumBatches - Number of chains, set to 0 on return
+    PortNumber  - Port on which the NBLs were received
+    ReceiveFlags - Flags associated with the receive
+
+Return Value:
+
+    None
+
+--*/
+{
+    ULONG           i;
+
+    for (i = 0; i < *pNumBatches; i++)
+    {
+        NdisMIndicateReceiveNetBufferLists(Batches[i].pVElan->MiniportAdapterHandle,
+                                           Batches[i].Head,
+                                           PortNumber,
+                                           Batches[i].Count,
+                                           ReceiveFlags);
+    }
+
+    *pNumBatches = 0;
+}
+
+
+static
+VOID
+PtAddReceiveToBatch(
+    IN PMUX_RECEIVE_BATCH           Batches,
+    IN OUT PULONG                   pNumBatches,
+    IN PVELAN                       pVElan,
+    IN PNET_BUFFER_LIST             NetBufferList,
+    IN NDIS_PORT_NUMBER             PortNumber,
+    IN ULONG                        ReceiveFlags
+    )
+/*++
+
+Routine Description:
+
+    Append a received NBL to the receive chain of its VELAN. If this
+    VELAN has no chain yet and the batch array is full, the chains
+    built so far are indicated first.
+
+Arguments:
+
+    Batches     - Receive chains being built
+    pNumBatches - Number of chains in use
+    pVElan      - VELAN the NBL is to be indicated on
+    NetBufferList - NBL to append; its next NBL link must be NULL
+    PortNumber  - Port on which the NBL was received
+    ReceiveFlags - Flags associated with the receive
+
+Return Value:
+
+    None
+
+--*/
+{
+    ULONG           i;
+
+    for (i = 0; i < *pNumBatches; i++)
+    {
+        if (Batches[i].pVElan == pVElan)
+        {
+            NET_BUFFER_LIST_NEXT_NBL(Batches[i].Tail) = NetBufferList;
+            Batches[i].Tail = NetBufferList;
+            Batches[i].Count++;
+            return;
+        }
+    }
+
+    if (*pNumBatches == MUX_MAX_RECEIVE_BATCHES)
+    {
+        PtIndicateReceiveBatches(Batches, pNumBatches, PortNumber, ReceiveFlags);
+    }
+
+    i = (*pNumBatches)++;
+    Batches[i].pVElan = pVElan;
+    Batches[i].Head = NetBufferList;
+    Batches[i].Tail = NetBufferList;
+    Batches[i].Count = 1;
+}
+
+
 VOID 
 PtReceiveNBL(
     IN NDIS_HANDLE       ProtocolBindingContext,
@@ -2654,7 +2892,10 @@ Arguments:
 Return Value:
     None
 
-NOTE: This receive code path is not efficient, we will optimize it later.
+NOTE: Directed NBLs are matched to their VELAN through the adapter's
+VELAN table and indicated as one chain per VELAN. Multicast and broadcast
+NBLs, and all NBLs while a VELAN is promiscuous or if the NBLs cannot be
+pended, are still checked against every VELAN and indicated one at a time.
 
 --*/
 {
@@ -2673,6 +2914,9 @@ NOTE: This receive code path is not efficient, we will optimize it later.
     UCHAR                   Data[6]={0,0,0,0,0,0};
     //BOOLEAN                 DispatchLevel;
     BOOLEAN                 bReturnNbl;
+    MUX_RECEIVE_BATCH       Batches[MUX_MAX_RECEIVE_BATCHES];
+    ULONG                   NumBatches = 0;
+    ULONG                   VlanId;
     
 #ifdef IEEE_VLAN_SUPPORT
     NDIS_STATUS             NdisStatus;
@@ -2802,6 +3046,91 @@ NOTE: This receive code path is not efficient, we will optimize it later.
 
             MUX_ACQUIRE_ADAPT_READ_LOCK(pAdapt, &LockState);
 
+            //
+            // A directed packet can only belong to the VELAN that owns its
+            // destination address, unless a VELAN is in promiscuous mode.
+            // Find that VELAN in the adapter's table and add the packet to
+            // its receive chain.
+            //
+#ifdef IEEE_VLAN_SUPPORT
+            VlanId = NdisPacket8021qInfo.TagHeader.VlanId;
+#else
+            VlanId = 0;
+#endif
+
+            if (!bIsMulticast &&
+                (pAdapt->PromiscuousVElanCount == 0) &&
+                (NDIS_TEST_RECEIVE_CAN_PEND(ReceiveFlags) == TRUE) &&
+                PtLookupVElan(pAdapt, pDstMac, VlanId, &pVElan))
+            {
+                do
+                {
+                    if ((pVElan == NULL) ||
+                        !PtMatchPacketToVElan(pVElan,
+                                              pDstMac,
+                                              bIsMulticast,
+                                              bIsBroadcast))
+                    {
+                        break;
+                    }
+
+                    MUX_INCR_PENDING_RECEIVES(pVElan);
+
+                    if ((pVElan->MiniportInitPending)
+                         || (pVElan->MiniportHalting)
+                         || (MUX_IS_LOW_POWER_STATE(pVElan->MPDevicePowerState)))
+                    {
+                        MUX_DECR_PENDING_RECEIVES(pVElan);
+                        break;
+                    }
+
+                    NdisAcquireSpinLock(&pVElan->PauseLock);
+
+                    if (pVElan->Paused)
+                    {
+                        NdisReleaseSpinLock(&pVElan->PauseLock);
+                        MUX_DECR_PENDING_RECEIVES(pVElan);
+                        break;
+                    }
+
+                    NdisReleaseSpinLock(&pVElan->PauseLock);
+
+#ifdef IEEE_VLAN_SUPPORT
+                    NdisStatus = PtHandleReceiveTaggingNB(pVElan, CurrentNetBufferList, &NdisPacket8021qInfo);
+
+                    if (NdisStatus != STATUS_SUCCESS)
+                    {
+                        MUX_DECR_PENDING_RECEIVES(pVElan);
+                        break;
+                    }
+#endif
+
+                    MUX_INCR_STATISTICS64(&pVElan->GoodReceives);
+
+                    //
+                    // The pending receive is released when the NBL comes
+                    // back in MPReturnNetBufferLists.
+                    //
+                    PtAddReceiveToBatch(Batches,
+                                        &NumBatches,
+                                        pVElan,
+                                        CurrentNetBufferList,
+                                        PortNumber,
+                                        ReceiveFlags);
+                    bReturnNbl = FALSE;
+                }
+                while (FALSE);
+
+                MUX_RELEASE_ADAPT_READ_LOCK(pAdapt, &LockState);
+                break;
+            }
+
+            //
+            // Indicate the chains built so far before this packet, so
+            // that packets are received in order on every VELAN.
+            //
+            PtIndicateReceiveBatches(Batches, &NumBatches, PortNumber, ReceiveFlags);
+
             // Set up the ref count before we start indicating the packet
 
             for (p = pAdapt->VElanList.Flink;
@@ -2947,6 +3276,8 @@ NOTE: This receive code path is not efficient, we will optimize it later.
         }
     }
 
+    PtIndicateReceiveBatches(Batches, &NumBatches, PortNumber, ReceiveFlags);
+
     if (ReturnNetBufferList != NULL)
     {
         NdisReturnNetBufferLists(pAdapt->BindingHandle,
@@ -2989,6 +3320,7 @@ Return Value:
     BOOLEAN                 DispatchLevel = FALSE;
 #ifdef IEEE_VLAN_SUPPORT
     PNET_BUFFER             MdlAllocatedNetBuffers;
+    PVOID                   Original8021qInfo;
     ULONG                   Flags = 0;
 #endif
 
@@ -3011,6 +3343,7 @@ Return Value:
 #ifdef IEEE_VLAN_SUPPORT
         Flags = SendContext->Flags;
         MdlAllocatedNetBuffers = SendContext->MdlAllocatedNetBuffers;
+        Original8021qInfo = SendContext->Original8021qInfo;
 #endif
 
         Status = NET_BUFFER_LIST_STATUS(CurrentNetBufferList);
@@ -3027,6 +3360,10 @@ Return Value:
                              NULL, 
                              MdlAllocatedNetBuffers);
         }
+        else if ((Flags & MUX_TAG_OFFLOADED) != 0)
+        {
+            NET_BUFFER_LIST_INFO(CurrentNetBufferList, Ieee8021QNetBufferListInfo) = Original8021qInfo;
+        }
 
 #endif
 
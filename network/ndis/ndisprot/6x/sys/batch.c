@@ -0,0 +1,1034 @@
+/*++
+
+Copyright (c) 2000  Microsoft Corporation
+
+Module Name:
+
+    batch.c
+
+Abstract:
+
+    Batched I/O on registered buffers. A client registers one buffer,
+    divided into fixed size slots, and then sends or receives many
+    frames per IOCTL by naming slots in that buffer. Sends are built
+    directly on the slot pages, without copying the data.
+
+Environment:
+
+    Kernel mode only.
+
+Revision History:
+
+--*/
+
+#include "precomp.h"
+
+#define __FILENUMBER 'HCTB'
+
+
+#pragma alloc_text(PAGE, ndisprotRegisterBuffers)
+#pragma alloc_text(PAGE, ndisprotUnregisterBuffers)
+
+
+static
+PNPROT_REGISTERED_BUFFERS
+ndisprotRefRegisteredBuffers(
+    IN PNDISPROT_OPEN_CONTEXT       pOpenContext
+    )
+/*++
+
+Routine Description:
+
+    Return the buffer registered on an open, with a reference added,
+    or NULL if there is none.
+
+--*/
+{
+    PNPROT_REGISTERED_BUFFERS   pBuffers;
+
+    NPROT_ACQUIRE_LOCK(&pOpenContext->Lock, FALSE);
+
+    pBuffers = pOpenContext->pRegisteredBuffers;
+    if (pBuffers != NULL)
+    {
+        NdisInterlockedIncrement((PLONG)&pBuffers->RefCount);
+    }
+
+    NPROT_RELEASE_LOCK(&pOpenContext->Lock, FALSE);
+
+    return (pBuffers);
+}
+
+
+static
+VOID
+ndisprotDerefRegisteredBuffers(
+    IN PNPROT_REGISTERED_BUFFERS    pBuffers
+    )
+/*++
+
+Routine Description:
+
+    Drop a reference on a registered buffer. The last reference unlocks
+    the user pages and frees everything. This may be called at
+    DISPATCH_LEVEL, from send completion.
+
+--*/
+{
+    PNPROT_EVENT                pReleasedEvent;
+    ULONG                       i;
+
+    if (NdisInterlockedDecrement((PLONG)&pBuffers->RefCount) != 0)
+    {
+        return;
+    }
+
+    pReleasedEvent = pBuffers->pReleasedEvent;
+
+    for (i = 0; i < pBuffers->SlotCount; i++)
+    {
+        if (pBuffers->SlotMdl[i] != NULL)
+        {
+            IoFreeMdl(pBuffers->SlotMdl[i]);
+        }
+    }
+
+    MmUnlockPages(pBuffers->pMdl);
+    IoFreeMdl(pBuffers->pMdl);
+
+    NPROT_FREE_MEM(pBuffers);
+
+    if (pReleasedEvent != NULL)
+    {
+        NPROT_SIGNAL_EVENT(pReleasedEvent);
+    }
+}
+
+
+NTSTATUS
+ndisprotRegisterBuffers(
+    IN PNDISPROT_OPEN_CONTEXT       pOpenContext,
+    _In_reads_bytes_(InputLength) IN PNDISPROT_REGISTER_BUFFERS pRegister,
+    IN ULONG                        InputLength
+    )
+/*++
+
+Routine Description:
+
+    Helper routine called to process IOCTL_NDISPROT_REGISTER_BUFFERS.
+    Lock the client's buffer in memory, map it, and build a partial MDL
+    for every slot. This runs in the context of the calling process.
+
+Arguments:
+
+    pOpenContext - pointer to open context
+    pRegister - describes the buffer and its slots
+    InputLength - length of the above
+
+Return Value:
+
+    NT status code.
+
+--*/
+{
+    NTSTATUS                    NtStatus;
+    PNPROT_REGISTERED_BUFFERS   pBuffers = NULL;
+    PMDL                        pMdl = NULL;
+    BOOLEAN                     bLocked = FALSE;
+    PUCHAR                      pUserVa;
+    ULONGLONG                   TotalLength;
+    ULONG                       AllocSize;
+    ULONG                       SlotSize;
+    ULONG                       SlotCount;
+    ULONG                       i;
+
+    PAGED_CODE();
+
+    do
+    {
+        if (InputLength < sizeof(NDISPROT_REGISTER_BUFFERS))
+        {
+            NtStatus = STATUS_BUFFER_TOO_SMALL;
+            break;
+        }
+
+        SlotSize = pRegister->SlotSize;
+        SlotCount = pRegister->SlotCount;
+        TotalLength = (ULONGLONG)SlotSize * SlotCount;
+
+        if ((SlotSize < sizeof(NDISPROT_ETH_HEADER)) ||
+            (SlotCount == 0) ||
+            (SlotCount > NDISPROT_MAX_REGISTERED_SLOTS) ||
+            (TotalLength > NDISPROT_MAX_REGISTERED_BYTES) ||
+            (pRegister->BufferAddress == 0) ||
+            (pRegister->BufferAddress != (ULONG_PTR)pRegister->BufferAddress))
+        {
+            DEBUGP(DL_WARN, ("RegisterBuffers: Open %p, bad slot size %d/count %d\n",
+                    pOpenContext, SlotSize, SlotCount));
+            NtStatus = STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        pUserVa = (PUCHAR)(ULONG_PTR)pRegister->BufferAddress;
+
+        //
+        //  The slot MDL pointers and the slot busy flags follow the
+        //  fixed part of the structure.
+        //
+        AllocSize = FIELD_OFFSET(NPROT_REGISTERED_BUFFERS, SlotMdl) +
+                    SlotCount * (sizeof(PMDL) + sizeof(LONG));
+
+        NPROT_ALLOC_MEM(pBuffers, AllocSize);
+        if (pBuffers == NULL)
+        {
+            NtStatus = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        NPROT_ZERO_MEM(pBuffers, AllocSize);
+        pBuffers->SlotSize = SlotSize;
+        pBuffers->SlotCount = SlotCount;
+        pBuffers->SlotBusy = (PLONG)&pBuffers->SlotMdl[SlotCount];
+
+        pMdl = IoAllocateMdl(pUserVa, (ULONG)TotalLength, FALSE, FALSE, NULL);
+        if (pMdl == NULL)
+        {
+            NtStatus = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        __try
+        {
+            MmProbeAndLockPages(pMdl, UserMode, IoModifyAccess);
+            bLocked = TRUE;
+        }
+        __except (EXCEPTION_EXECUTE_HANDLER)
+        {
+            DEBUGP(DL_WARN, ("RegisterBuffers: Open %p, failed to lock buffer %p\n",
+                    pOpenContext, pUserVa));
+        }
+
+        if (!bLocked)
+        {
+            NtStatus = STATUS_INVALID_USER_BUFFER;
+            break;
+        }
+
+        pBuffers->pSystemVa = MmGetSystemAddressForMdlSafe(pMdl, NormalPagePriority);
+        if (pBuffers->pSystemVa == NULL)
+        {
+            NtStatus = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        pBuffers->pMdl = pMdl;
+
+        for (i = 0; i < SlotCount; i++)
+        {
+            pBuffers->SlotMdl[i] = IoAllocateMdl(pUserVa + i * SlotSize,
+                                                 SlotSize,
+                                                 FALSE,
+                                                 FALSE,
+                                                 NULL);
+            if (pBuffers->SlotMdl[i] == NULL)
+            {
+                break;
+            }
+
+            IoBuildPartialMdl(pMdl, pBuffers->SlotMdl[i], pUserVa + i * SlotSize, SlotSize);
+        }
+
+        if (i != SlotCount)
+        {
+            NtStatus = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        pBuffers->RefCount = 1;     // the open's reference
+
+        NPROT_ACQUIRE_LOCK(&pOpenContext->Lock, FALSE);
+
+        if (pOpenContext->pRegisteredBuffers != NULL)
+        {
+            NPROT_RELEASE_LOCK(&pOpenContext->Lock, FALSE);
+
+            DEBUGP(DL_WARN, ("RegisterBuffers: Open %p already has buffers %p\n",
+                    pOpenContext, pOpenContext->pRegisteredBuffers));
+            NtStatus = STATUS_DEVICE_BUSY;
+            break;
+        }
+
+        pOpenContext->pRegisteredBuffers = pBuffers;
+
+        NPROT_RELEASE_LOCK(&pOpenContext->Lock, FALSE);
+
+        DEBUGP(DL_INFO, ("RegisterBuffers: Open %p, buffers %p, %d slots of %d bytes\n",
+                pOpenContext, pBuffers, SlotCount, SlotSize));
+
+        pBuffers = NULL;
+        pMdl = NULL;
+        NtStatus = STATUS_SUCCESS;
+    }
+    while (FALSE);
+
+    if (pBuffers != NULL)
+    {
+        for (i = 0; i < pBuffers->SlotCount; i++)
+        {
+            if (pBuffers->SlotMdl[i] != NULL)
+            {
+                IoFreeMdl(pBuffers->SlotMdl[i]);
+            }
+        }
+
+        NPROT_FREE_MEM(pBuffers);
+    }
+
+    if (pMdl != NULL)
+    {
+        if (bLocked)
+        {
+            MmUnlockPages(pMdl);
+        }
+
+        IoFreeMdl(pMdl);
+    }
+
+    return (NtStatus);
+}
+
+
+NTSTATUS
+ndisprotUnregisterBuffers(
+    IN PNDISPROT_OPEN_CONTEXT       pOpenContext
+    )
+/*++
+
+Routine Description:
+
+    Helper routine called to process IOCTL_NDISPROT_UNREGISTER_BUFFERS,
+    and on cleanup. Detach the registered buffer from the open and wait
+    for all batched sends from it to complete, so that the user pages
+    are unlocked before we return.
+
+Arguments:
+
+    pOpenContext - pointer to open context
+
+Return Value:
+
+    STATUS_SUCCESS, or STATUS_INVALID_DEVICE_STATE if no buffer was
+    registered.
+
+--*/
+{
+    PNPROT_REGISTERED_BUFFERS   pBuffers;
+    NPROT_EVENT                 ReleasedEvent;
+
+    PAGED_CODE();
+
+    NPROT_ACQUIRE_LOCK(&pOpenContext->Lock, FALSE);
+
+    pBuffers = pOpenContext->pRegisteredBuffers;
+    pOpenContext->pRegisteredBuffers = NULL;
+
+    NPROT_RELEASE_LOCK(&pOpenContext->Lock, FALSE);
+
+    if (pBuffers == NULL)
+    {
+        return (STATUS_INVALID_DEVICE_STATE);
+    }
+
+    DEBUGP(DL_INFO, ("UnregisterBuffers: Open %p, buffers %p\n",
+            pOpenContext, pBuffers));
+
+    NPROT_INIT_EVENT(&ReleasedEvent);
+    pBuffers->pReleasedEvent = &ReleasedEvent;
+
+    ndisprotDerefRegisteredBuffers(pBuffers);   // the open's reference
+
+    NPROT_WAIT_EVENT(&ReleasedEvent, 0);
+
+    return (STATUS_SUCCESS);
+}
+
+
+static
+VOID
+ndisprotFreeBatchNetBufferList(
+    IN PNPROT_REGISTERED_BUFFERS    pBuffers,
+    IN PNET_BUFFER_LIST             pNetBufferList,
+    IN BOOLEAN                      DispatchLevel
+    )
+/*++
+
+Routine Description:
+
+    Release a net buffer list built on a registered buffer slot: free
+    it, make the slot available again, and drop the reference it held
+    on the registered buffer.
+
+--*/
+{
+    ULONG                       Slot;
+
+    Slot = NPROT_SEND_NBL_RSVD(pNetBufferList)->Slot;
+
+    NPROT_DEREF_SEND_NBL(pNetBufferList, DispatchLevel);
+
+    InterlockedExchange(&pBuffers->SlotBusy[Slot], 0);
+
+    ndisprotDerefRegisteredBuffers(pBuffers);   // batch send complete
+}
+
+
+NTSTATUS
+ndisprotWriteBatch(
+    IN PNDISPROT_OPEN_CONTEXT       pOpenContext,
+    IN PIRP                         pIrp
+    )
+/*++
+
+Routine Description:
+
+    Helper routine called to process IOCTL_NDISPROT_WRITE_BATCH. Build a
+    net buffer list on each slot listed in the request, and send them
+    all with one call to NdisSendNetBufferLists. The IRP is completed
+    from send completion, when the last of them is done.
+
+    Unlike Write IRPs, a batch cannot be cancelled once it is sent.
+
+Arguments:
+
+    pOpenContext - pointer to open context
+    pIrp - the IOCTL IRP
+
+Return Value:
+
+    STATUS_PENDING if the batch was sent, otherwise an error status; the
+    caller completes the IRP in that case.
+
+--*/
+{
+    PIO_STACK_LOCATION          pIrpSp;
+    PNDISPROT_BATCH             pBatchRequest;
+    PNPROT_REGISTERED_BUFFERS   pBuffers;
+    PNPROT_SEND_BATCH           pBatch = NULL;
+    PNET_BUFFER_LIST            pNetBufferList;
+    PNET_BUFFER_LIST            pFirstNetBufferList = NULL;
+    PNET_BUFFER_LIST            pLastNetBufferList = NULL;
+    NDISPROT_ETH_HEADER UNALIGNED *pEthHeader;
+    NTSTATUS                    NtStatus;
+    ULONG                       FrameCount;
+    ULONG                       Slot;
+    ULONG                       Length;
+    ULONG                       i;
+
+    pIrpSp = IoGetCurrentIrpStackLocation(pIrp);
+    pBatchRequest = (PNDISPROT_BATCH)pIrp->AssociatedIrp.SystemBuffer;
+
+    if ((pIrpSp->Parameters.DeviceIoControl.InputBufferLength < FIELD_OFFSET(NDISPROT_BATCH, Frames)) ||
+        (pIrpSp->Parameters.DeviceIoControl.OutputBufferLength < FIELD_OFFSET(NDISPROT_BATCH, Frames)))
+    {
+        return (STATUS_BUFFER_TOO_SMALL);
+    }
+
+    FrameCount = pBatchRequest->FrameCount;
+
+    if ((FrameCount == 0) || (FrameCount > NDISPROT_MAX_BATCH_FRAMES))
+    {
+        return (STATUS_INVALID_PARAMETER);
+    }
+
+    if (pIrpSp->Parameters.DeviceIoControl.InputBufferLength <
+            FIELD_OFFSET(NDISPROT_BATCH, Frames) + FrameCount * sizeof(NDISPROT_BATCH_FRAME))
+    {
+        return (STATUS_BUFFER_TOO_SMALL);
+    }
+
+    pBuffers = ndisprotRefRegisteredBuffers(pOpenContext);
+    if (pBuffers == NULL)
+    {
+        DEBUGP(DL_WARN, ("WriteBatch: Open %p has no registered buffers\n",
+                pOpenContext));
+        return (STATUS_INVALID_DEVICE_STATE);
+    }
+
+    do
+    {
+        NPROT_ALLOC_MEM(pBatch, sizeof(NPROT_SEND_BATCH));
+        if (pBatch == NULL)
+        {
+            NtStatus = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        pBatch->pIrp = pIrp;
+        pBatch->pBuffers = pBuffers;
+        pBatch->FrameCount = FrameCount;
+        pBatch->Outstanding = FrameCount;
+        pBatch->Succeeded = 0;
+
+        NtStatus = STATUS_SUCCESS;
+
+        for (i = 0; i < FrameCount; i++)
+        {
+            Slot = pBatchRequest->Frames[i].Slot;
+            Length = pBatchRequest->Frames[i].Length;
+
+            //
+            //  Apply the same checks as a Write IRP does.
+            //
+            if ((Slot >= pBuffers->SlotCount) ||
+                (Length > pBuffers->SlotSize) ||
+                (Length < sizeof(NDISPROT_ETH_HEADER)))
+            {
+                NtStatus = STATUS_INVALID_PARAMETER;
+                break;
+            }
+
+            if (Length > (pOpenContext->MaxFrameSize + sizeof(NDISPROT_ETH_HEADER)))
+            {
+                DEBUGP(DL_WARN, ("WriteBatch: Open %p: frame length (%d)"
+                        " larger than max frame size (%d)\n",
+                        pOpenContext, Length, pOpenContext->MaxFrameSize));
+                NtStatus = STATUS_INVALID_BUFFER_SIZE;
+                break;
+            }
+
+            pEthHeader = (NDISPROT_ETH_HEADER UNALIGNED *)
+                            (pBuffers->pSystemVa + Slot * pBuffers->SlotSize);
+
+            if ((pEthHeader->EthType != Globals.EthType) ||
+                !NPROT_MEM_CMP(pEthHeader->SrcAddr, pOpenContext->CurrentAddress, NPROT_MAC_ADDR_LEN))
+            {
+                DEBUGP(DL_WARN, ("WriteBatch: Open %p, failing frame %d in slot %d\n",
+                        pOpenContext, i, Slot));
+                NtStatus = STATUS_INVALID_PARAMETER;
+                break;
+            }
+
+            //
+            //  A slot can carry only one frame at a time.
+            //
+            if (InterlockedCompareExchange(&pBuffers->SlotBusy[Slot], 1, 0) != 0)
+            {
+                NtStatus = STATUS_DEVICE_BUSY;
+                break;
+            }
+
+            pNetBufferList = NdisAllocateNetBufferAndNetBufferList(
+                                pOpenContext->SendNetBufferListPool,
+                                sizeof(NPROT_SEND_NETBUFLIST_RSVD), //Request control offset delta
+                                0,           // back fill size
+                                pBuffers->SlotMdl[Slot],
+                                0,          // Data offset
+                                Length);
+
+            if (pNetBufferList == NULL)
+            {
+                InterlockedExchange(&pBuffers->SlotBusy[Slot], 0);
+                NtStatus = STATUS_INSUFFICIENT_RESOURCES;
+                break;
+            }
+
+            NdisInterlockedIncrement((PLONG)&pBuffers->RefCount);  // batch send
+
+            NPROT_SEND_NBL_RSVD(pNetBufferList)->RefCount = 1;
+            NPROT_SEND_NBL_RSVD(pNetBufferList)->pIrp = pIrp;
+            NPROT_SEND_NBL_RSVD(pNetBufferList)->pBatch = pBatch;
+            NPROT_SEND_NBL_RSVD(pNetBufferList)->Slot = Slot;
+
+            pNetBufferList->SourceHandle = pOpenContext->BindingHandle;
+            NET_BUFFER_LIST_NEXT_NBL(pNetBufferList) = NULL;
+
+            if (pFirstNetBufferList == NULL)
+            {
+                pFirstNetBufferList = pNetBufferList;
+            }
+            else
+            {
+                NET_BUFFER_LIST_NEXT_NBL(pLastNetBufferList) = pNetBufferList;
+            }
+            pLastNetBufferList = pNetBufferList;
+        }
+
+        if (!NT_SUCCESS(NtStatus))
+        {
+            break;
+        }
+
+        NPROT_ACQUIRE_LOCK(&pOpenContext->Lock, FALSE);
+
+        if (!NPROT_TEST_FLAGS(pOpenContext->Flags, NPROTO_BIND_FLAGS, NPROTO_BIND_ACTIVE) ||
+            (pOpenContext->State != NdisprotRunning) ||
+            (pOpenContext->PowerState != NetDeviceStateD0))
+        {
+            NPROT_RELEASE_LOCK(&pOpenContext->Lock, FALSE);
+
+            DEBUGP(DL_INFO, ("WriteBatch: Open %p is not ready\n", pOpenContext));
+            NtStatus = STATUS_UNSUCCESSFUL;
+            break;
+        }
+
+        pOpenContext->PendedSendCount += FrameCount;
+
+        NPROT_RELEASE_LOCK(&pOpenContext->Lock, FALSE);
+
+        for (i = 0; i < FrameCount; i++)
+        {
+            NPROT_REF_OPEN(pOpenContext);  // pended batch send
+        }
+
+        IoMarkIrpPending(pIrp);
+
+        DEBUGP(DL_LOUD, ("WriteBatch: Open %p, IRP %p, sending %d frames\n",
+                pOpenContext, pIrp, FrameCount));
+
+        NdisSendNetBufferLists(
+                        pOpenContext->BindingHandle,
+                        pFirstNetBufferList,
+                        NDIS_DEFAULT_PORT_NUMBER,
+                        NDIS_SEND_FLAGS_CHECK_FOR_LOOPBACK);
+
+        NtStatus = STATUS_PENDING;
+    }
+    while (FALSE);
+
+    if (NtStatus != STATUS_PENDING)
+    {
+        while (pFirstNetBufferList != NULL)
+        {
+            pNetBufferList = pFirstNetBufferList;
+            pFirstNetBufferList = NET_BUFFER_LIST_NEXT_NBL(pNetBufferList);
+
+            ndisprotFreeBatchNetBufferList(pBuffers, pNetBufferList, FALSE);
+        }
+
+        if (pBatch != NULL)
+        {
+            NPROT_FREE_MEM(pBatch);
+        }
+    }
+
+    ndisprotDerefRegisteredBuffers(pBuffers);   // lookup reference
+
+    return (NtStatus);
+}
+
+
+VOID
+ndisprotCompleteBatchSend(
+    IN PNDISPROT_OPEN_CONTEXT       pOpenContext,
+    IN PNET_BUFFER_LIST             pNetBufferList,
+    IN BOOLEAN                      DispatchLevel
+    )
+/*++
+
+Routine Description:
+
+    Called from send completion for each net buffer list that belongs to
+    a write batch. When the last one in the batch completes, we complete
+    the IOCTL IRP with the number of frames sent successfully.
+
+    The caller still drops the pended send count and the open reference
+    for this net buffer list.
+
+Arguments:
+
+    pOpenContext - pointer to open context
+    pNetBufferList - the completed net buffer list
+    DispatchLevel - TRUE if the caller is at DISPATCH level
+
+Return Value:
+
+    None
+
+--*/
+{
+    PNPROT_SEND_BATCH           pBatch;
+    PIRP                        pIrp;
+
+    UNREFERENCED_PARAMETER(pOpenContext);
+
+    pBatch = NPROT_SEND_NBL_RSVD(pNetBufferList)->pBatch;
+
+    if (NET_BUFFER_LIST_STATUS(pNetBufferList) == NDIS_STATUS_SUCCESS)
+    {
+        NdisInterlockedIncrement((PLONG)&pBatch->Succeeded);
+    }
+
+    ndisprotFreeBatchNetBufferList(pBatch->pBuffers, pNetBufferList, DispatchLevel);
+
+    if (NdisInterlockedDecrement((PLONG)&pBatch->Outstanding) != 0)
+    {
+        return;
+    }
+
+    pIrp = pBatch->pIrp;
+
+    ((PNDISPROT_BATCH)pIrp->AssociatedIrp.SystemBuffer)->FrameCount = pBatch->Succeeded;
+    pIrp->IoStatus.Information = FIELD_OFFSET(NDISPROT_BATCH, Frames);
+    pIrp->IoStatus.Status = (pBatch->Succeeded != 0)? STATUS_SUCCESS: STATUS_UNSUCCESSFUL;
+
+    DEBUGP(DL_INFO, ("CompleteBatchSend: Open %p, IRP %p, %d of %d frames sent\n",
+            pOpenContext, pIrp, pBatch->Succeeded, pBatch->FrameCount));
+
+    NPROT_FREE_MEM(pBatch);
+
+    IoCompleteRequest(pIrp, IO_NO_INCREMENT);
+}
+
+
+static
+ULONG
+ndisprotCopyReceiveNetBufferList(
+    IN PNET_BUFFER_LIST             pNetBufferList,
+    _Out_writes_bytes_to_(DstLength, return) IN PUCHAR pDst,
+    IN ULONG                        DstLength
+    )
+/*++
+
+Routine Description:
+
+    Copy as much of a received frame as fits into a slot.
+
+Return Value:
+
+    The number of bytes copied.
+
+--*/
+{
+    PMDL                pMdl;
+    PUCHAR              pSrc;
+    ULONG               BytesAvailable;
+    ULONG               BytesRemaining = DstLength;
+    ULONG               SrcTotalLength;
+    ULONG               Offset;
+    ULONG               BytesToCopy;
+
+    pMdl = NET_BUFFER_CURRENT_MDL(NET_BUFFER_LIST_FIRST_NB(pNetBufferList));
+    SrcTotalLength = NET_BUFFER_DATA_LENGTH(NET_BUFFER_LIST_FIRST_NB(pNetBufferList));
+    Offset = NET_BUFFER_CURRENT_MDL_OFFSET(NET_BUFFER_LIST_FIRST_NB(pNetBufferList));
+
+    while (BytesRemaining && (pMdl != NULL) && SrcTotalLength)
+    {
+        pSrc = NULL;
+        NdisQueryMdl(pMdl, &pSrc, &BytesAvailable, NormalPagePriority);
+
+        if (pSrc == NULL)
+        {
+            break;
+        }
+
+        NPROT_ASSERT(BytesAvailable > Offset);
+
+        BytesToCopy = MIN(BytesAvailable - Offset, BytesRemaining);
+        BytesToCopy = MIN(BytesToCopy, SrcTotalLength);
+
+        NPROT_COPY_MEM(pDst, pSrc + Offset, BytesToCopy);
+        BytesRemaining -= BytesToCopy;
+        pDst += BytesToCopy;
+        SrcTotalLength -= BytesToCopy;
+
+        //
+        // CurrentMdlOffset is used only for the first Mdl processed.
+        //
+        Offset = 0;
+
+        NdisGetNextMdl(pMdl, &pMdl);
+    }
+
+    return (DstLength - BytesRemaining);
+}
+
+
+static
+NTSTATUS
+ndisprotFillBatchSlots(
+    IN PNDISPROT_OPEN_CONTEXT       pOpenContext,
+    IN PNDISPROT_BATCH              pBatchRequest,
+    IN PLIST_ENTRY                  pRcvList,
+    OUT PULONG                      pBytesReturned
+    )
+/*++
+
+Routine Description:
+
+    Copy the received packets on pRcvList into the slots listed in a
+    batch read request, in order, and free them. There are never more
+    packets than slots. If the buffer has been unregistered or replaced
+    since the request was checked, the packets are dropped.
+
+Arguments:
+
+    pOpenContext - pointer to open context
+    pBatchRequest - the batch read request; FrameCount and the lengths
+                    are updated
+    pRcvList - received packets, already dequeued
+    pBytesReturned - place to return the length of the output
+
+Return Value:
+
+    NT status code.
+
+--*/
+{
+    PNPROT_REGISTERED_BUFFERS   pBuffers;
+    PNET_BUFFER_LIST            pRcvNetBufList;
+    PLIST_ENTRY                 pRcvNetBufListEntry;
+    NTSTATUS                    NtStatus = STATUS_SUCCESS;
+    ULONG                       Filled = 0;
+    ULONG                       Slot;
+
+    pBuffers = ndisprotRefRegisteredBuffers(pOpenContext);
+    if (pBuffers == NULL)
+    {
+        NtStatus = STATUS_INVALID_DEVICE_STATE;
+    }
+
+    while (!NPROT_IS_LIST_EMPTY(pRcvList))
+    {
+        pRcvNetBufListEntry = NPROT_REMOVE_HEAD_LIST(pRcvList);
+
+        pRcvNetBufList = NPROT_RCV_NBL_FROM_LIST_ENTRY(pRcvNetBufListEntry);
+        NPROT_ASSERT(pRcvNetBufList != NULL);
+        _Analysis_assume_(pRcvNetBufList != NULL);
+        NPROT_RCV_NBL_FROM_LIST_ENTRY(pRcvNetBufListEntry) = NULL;
+
+        if (NT_SUCCESS(NtStatus))
+        {
+            NPROT_ASSERT(Filled < pBatchRequest->FrameCount);
+
+            Slot = pBatchRequest->Frames[Filled].Slot;
+
+            if (Slot < pBuffers->SlotCount)
+            {
+                pBatchRequest->Frames[Filled].Length = ndisprotCopyReceiveNetBufferList(
+                                                        pRcvNetBufList,
+                                                        pBuffers->pSystemVa + Slot * pBuffers->SlotSize,
+                                                        pBuffers->SlotSize);
+                Filled++;
+            }
+            else
+            {
+                NtStatus = STATUS_INVALID_PARAMETER;
+            }
+        }
+
+        ndisprotFreeReceiveNetBufferList(pOpenContext, pRcvNetBufList, FALSE);
+    }
+
+    if (pBuffers != NULL)
+    {
+        ndisprotDerefRegisteredBuffers(pBuffers);
+    }
+
+    DEBUGP(DL_LOUD, ("FillBatchSlots: Open %p, filled %d of %d slots, status %x\n",
+            pOpenContext, Filled, pBatchRequest->FrameCount, NtStatus));
+
+    if (NT_SUCCESS(NtStatus))
+    {
+        pBatchRequest->FrameCount = Filled;
+        *pBytesReturned = FIELD_OFFSET(NDISPROT_BATCH, Frames) + Filled * sizeof(NDISPROT_BATCH_FRAME);
+    }
+    else
+    {
+        *pBytesReturned = 0;
+    }
+
+    return (NtStatus);
+}
+
+
+NTSTATUS
+ndisprotReadBatch(
+    IN PNDISPROT_OPEN_CONTEXT       pOpenContext,
+    IN PIRP                         pIrp,
+    OUT PULONG                      pBytesReturned
+    )
+/*++
+
+Routine Description:
+
+    Helper routine called to process IOCTL_NDISPROT_READ_BATCH. Move up
+    to FrameCount queued receives into the slots listed in the request.
+    If nothing is queued, the IRP is pended on the Read IRP queue, and
+    ndisprotServiceReads completes it with as many packets as have
+    arrived by the time it runs.
+
+Arguments:
+
+    pOpenContext - pointer to open context
+    pIrp - the IOCTL IRP
+    pBytesReturned - place to return the length of the output
+
+Return Value:
+
+    STATUS_PENDING if the IRP was pended, otherwise the status to
+    complete it with.
+
+--*/
+{
+    PIO_STACK_LOCATION          pIrpSp;
+    PNDISPROT_BATCH             pBatchRequest;
+    PNPROT_REGISTERED_BUFFERS   pBuffers;
+    LIST_ENTRY                  RcvList;
+    NTSTATUS                    NtStatus;
+    ULONG                       FrameCount;
+    ULONG                       Count;
+    ULONG                       Length;
+    ULONG                       i;
+
+    *pBytesReturned = 0;
+
+    pIrpSp = IoGetCurrentIrpStackLocation(pIrp);
+    pBatchRequest = (PNDISPROT_BATCH)pIrp->AssociatedIrp.SystemBuffer;
+
+    if (pIrpSp->Parameters.DeviceIoControl.InputBufferLength < FIELD_OFFSET(NDISPROT_BATCH, Frames))
+    {
+        return (STATUS_BUFFER_TOO_SMALL);
+    }
+
+    FrameCount = pBatchRequest->FrameCount;
+
+    if ((FrameCount == 0) || (FrameCount > NDISPROT_MAX_BATCH_FRAMES))
+    {
+        return (STATUS_INVALID_PARAMETER);
+    }
+
+    Length = FIELD_OFFSET(NDISPROT_BATCH, Frames) + FrameCount * sizeof(NDISPROT_BATCH_FRAME);
+
+    if ((pIrpSp->Parameters.DeviceIoControl.InputBufferLength < Length) ||
+        (pIrpSp->Parameters.DeviceIoControl.OutputBufferLength < Length))
+    {
+        return (STATUS_BUFFER_TOO_SMALL);
+    }
+
+    pBuffers = ndisprotRefRegisteredBuffers(pOpenContext);
+    if (pBuffers == NULL)
+    {
+        DEBUGP(DL_WARN, ("ReadBatch: Open %p has no registered buffers\n",
+                pOpenContext));
+        return (STATUS_INVALID_DEVICE_STATE);
+    }
+
+    NtStatus = STATUS_SUCCESS;
+
+    for (i = 0; i < FrameCount; i++)
+    {
+        if (pBatchRequest->Frames[i].Slot >= pBuffers->SlotCount)
+        {
+            NtStatus = STATUS_INVALID_PARAMETER;
+            break;
+        }
+    }
+
+    ndisprotDerefRegisteredBuffers(pBuffers);
+
+    if (!NT_SUCCESS(NtStatus))
+    {
+        return (NtStatus);
+    }
+
+    NPROT_INIT_LIST_HEAD(&RcvList);
+
+    NPROT_ACQUIRE_LOCK(&pOpenContext->Lock, FALSE);
+
+    if (!NPROT_TEST_FLAGS(pOpenContext->Flags, NPROTO_BIND_FLAGS, NPROTO_BIND_ACTIVE))
+    {
+        NPROT_RELEASE_LOCK(&pOpenContext->Lock, FALSE);
+        return (STATUS_INVALID_HANDLE);
+    }
+
+    Count = ndisprotDequeueReceiveNetBufferLists(pOpenContext, FrameCount, &RcvList);
+
+    if (Count == 0)
+    {
+        //
+        //  Nothing queued: pend this IRP as NdisprotRead does.
+        //
+        IoSetCancelRoutine(pIrp, NdisprotCancelRead);
+
+        if (pIrp->Cancel &&
+            IoSetCancelRoutine(pIrp, NULL))
+        {
+            NtStatus = STATUS_CANCELLED;
+        }
+        else
+        {
+            NPROT_INSERT_TAIL_LIST(&pOpenContext->PendedReads, &pIrp->Tail.Overlay.ListEntry);
+            pIrp->Tail.Overlay.DriverContext[0] = (PVOID)pOpenContext;
+
+            NPROT_REF_OPEN(pOpenContext);  // pended batch read IRP
+            pOpenContext->PendedReadCount++;
+            IoMarkIrpPending(pIrp);
+
+            NtStatus = STATUS_PENDING;
+        }
+
+        NPROT_RELEASE_LOCK(&pOpenContext->Lock, FALSE);
+
+        //
+        //  A packet may have been queued since we looked.
+        //
+        if (NtStatus == STATUS_PENDING)
+        {
+            ndisprotServiceReads(pOpenContext);
+        }
+
+        return (NtStatus);
+    }
+
+    NPROT_RELEASE_LOCK(&pOpenContext->Lock, FALSE);
+
+    while (Count-- != 0)
+    {
+        NPROT_DEREF_OPEN(pOpenContext);  // ReadBatch: dequeue rcv packet
+    }
+
+    return (ndisprotFillBatchSlots(pOpenContext, pBatchRequest, &RcvList, pBytesReturned));
+}
+
+
+VOID
+ndisprotCompleteBatchRead(
+    IN PNDISPROT_OPEN_CONTEXT       pOpenContext,
+    IN PIRP                         pIrp,
+    IN PLIST_ENTRY                  pRcvList
+    )
+/*++
+
+Routine Description:
+
+    Called from ndisprotServiceReads to complete a pended batch read
+    with the packets it has dequeued for it.
+
+Arguments:
+
+    pOpenContext - pointer to open context
+    pIrp - the pended IOCTL_NDISPROT_READ_BATCH IRP
+    pRcvList - the packets for it; the open references are already
+               dropped
+
+Return Value:
+
+    None
+
+--*/
+{
+    ULONG                       BytesReturned;
+
+    pIrp->IoStatus.Status = ndisprotFillBatchSlots(
+                                pOpenContext,
+                                (PNDISPROT_BATCH)pIrp->AssociatedIrp.SystemBuffer,
+                                pRcvList,
+                                &BytesReturned);
+    pIrp->IoStatus.Information = BytesReturned;
+
+    DEBUGP(DL_INFO, ("CompleteBatchRead: Open %p, IRP %p completed with %d bytes\n",
+        pOpenContext, pIrp, BytesReturned));
+
+    IoCompleteRequest(pIrp, IO_NO_INCREMENT);
+}
+
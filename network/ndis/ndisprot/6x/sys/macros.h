@@ -83,6 +83,17 @@ Revision History:
 
 #endif // DBG
 
+//
+//  Processor numbering, for the per-processor receive queues.
+//
+#if (NDIS_SUPPORT_NDIS620)
+#define NPROT_MAX_PROCESSOR_COUNT()         NdisGroupMaxProcessorCount(ALL_PROCESSOR_GROUPS)
+#define NPROT_CURRENT_PROCESSOR_INDEX()     NdisCurrentProcessorIndex()
+#else
+#define NPROT_MAX_PROCESSOR_COUNT()         NdisSystemProcessorCount()
+#define NPROT_CURRENT_PROCESSOR_INDEX()     KeGetCurrentProcessorNumber()
+#endif
+
 //
 //  List manipulation.
 //
@@ -96,9 +96,15 @@ Return Value:
         NPROT_INIT_LOCK(&pOpenContext->Lock);
         NPROT_INIT_LIST_HEAD(&pOpenContext->PendedReads);
         NPROT_INIT_LIST_HEAD(&pOpenContext->PendedWrites);
-        NPROT_INIT_LIST_HEAD(&pOpenContext->RecvNetBufListQueue);
         NPROT_INIT_EVENT(&pOpenContext->PoweredUpEvent);
 
+        Status = ndisprotAllocateReceiveQueues(pOpenContext);
+        if (Status != NDIS_STATUS_SUCCESS)
+        {
+            NPROT_FREE_MEM(pOpenContext);
+            break;
+        }
+
 
         //
         //  Start off by assuming that the device below is powered up.
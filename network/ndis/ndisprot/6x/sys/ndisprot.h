@@ -111,6 +111,22 @@ typedef enum _NDISPROT_OPEN_STATE{
 //  Uncompleted write IRPs (outstanding sends)
 //  Existence of NDIS binding
 //
+struct _NPROT_REGISTERED_BUFFERS;
+
+//
+//  Received packets are queued on the queue of the processor they were
+//  indicated on. With RSS, each queue sees only the flows steered to its
+//  processor, and receives on different processors don't contend for a
+//  lock. Each queue is on its own cache line.
+//
+typedef struct DECLSPEC_CACHEALIGN _NPROT_RECV_QUEUE
+{
+    NPROT_LOCK              Lock;
+    LIST_ENTRY              NetBufListQueue;
+    ULONG                   NetBufListCount;
+
+} NPROT_RECV_QUEUE, *PNPROT_RECV_QUEUE;
+
 typedef struct _NDISPROT_OPEN_CONTEXT
 {
     LIST_ENTRY              Link;           // Link into global list
@@ -135,8 +151,19 @@ typedef struct _NDISPROT_OPEN_CONTEXT
 
     LIST_ENTRY              PendedReads;    // pended Read IRPs
     ULONG                   PendedReadCount;
-    LIST_ENTRY              RecvNetBufListQueue;
-    ULONG                   RecvNetBufListCount;
+
+    //
+    //  Packets are taken off the receive queues only with Lock held,
+    //  so RecvNetBufListCount can't drop to zero under a reader that
+    //  holds Lock and has seen it non-zero.
+    //
+    PNPROT_RECV_QUEUE       pRecvQueues;    // RecvQueueCount entries
+    PVOID                   pRecvQueuesBuffer;  // unaligned allocation
+    ULONG                   RecvQueueCount;
+    ULONG                   NextRecvQueue;  // protected by Lock
+    LONG                    RecvNetBufListCount;  // all queues
+
+    struct _NPROT_REGISTERED_BUFFERS *pRegisteredBuffers;  // for batch I/O
 
     NET_DEVICE_POWER_STATE  PowerState;
     NDIS_EVENT              PoweredUpEvent; // signalled iff PowerState is D0
@@ -246,12 +273,64 @@ typedef struct _NDISPROT_REQUEST
 //  to its pool. It is used to synchronize between a thread completing
 //  a send and a thread attempting to cancel a send.
 //
+//  Net buffer lists sent by IOCTL_NDISPROT_WRITE_BATCH also point to the
+//  batch they belong to and the registered buffer slot they were built
+//  on. pBatch is NULL for Write IRP sends.
+//
+struct _NPROT_SEND_BATCH;
+
 typedef struct _NPROT_SEND_NETBUFLIST_RSVD
 {
     PIRP                    pIrp;
     ULONG                   RefCount;
+    struct _NPROT_SEND_BATCH *pBatch;
+    ULONG                   Slot;
 
 } NPROT_SEND_NETBUFLIST_RSVD, *PNPROT_SEND_NETBUFLIST_RSVD;
+
+//
+//  A user buffer registered with IOCTL_NDISPROT_REGISTER_BUFFERS. The
+//  whole buffer is described by pMdl and locked; each slot has a partial
+//  MDL of its own, so that a slot can be chained straight into a send
+//  net buffer list.
+//
+//  The open holds one reference, and every frame being sent from a slot
+//  holds another. When the last reference goes away the buffer is
+//  unlocked and freed, and pReleasedEvent (if any) is signalled.
+//
+typedef struct _NPROT_REGISTERED_BUFFERS
+{
+    ULONG                   RefCount;
+    PNPROT_EVENT            pReleasedEvent;
+    PMDL                    pMdl;
+    PUCHAR                  pSystemVa;
+    ULONG                   SlotSize;
+    ULONG                   SlotCount;
+    PLONG                   SlotBusy;       // non-zero while being sent
+    PMDL                    SlotMdl[1];     // SlotCount entries
+
+} NPROT_REGISTERED_BUFFERS, *PNPROT_REGISTERED_BUFFERS;
+
+//
+//  Tracks one IOCTL_NDISPROT_WRITE_BATCH until every frame in it has
+//  been send-completed.
+//
+typedef struct _NPROT_SEND_BATCH
+{
+    PIRP                        pIrp;
+    PNPROT_REGISTERED_BUFFERS   pBuffers;
+    ULONG                       FrameCount;
+    ULONG                       Outstanding;
+    ULONG                       Succeeded;
+
+} NPROT_SEND_BATCH, *PNPROT_SEND_BATCH;
+
+//
+//  Receive queue depth while a buffer is registered: batched reads want
+//  more than the MAX_RECV_QUEUE_SIZE packets that Read IRPs make do with.
+//  Both limits are per receive queue.
+//
+#define MAX_BATCH_RECV_QUEUE_SIZE    NDISPROT_MAX_BATCH_FRAMES
 //
 //  Receive packet pool bounds
 //
@@ -259,7 +338,7 @@ typedef struct _NPROT_SEND_NETBUFLIST_RSVD
 #define MAX_RECV_PACKET_POOL_SIZE    20
 
 //
-//  Max receive packets we allow to be queued up
+//  Max receive packets we allow to be queued up on each receive queue
 //
 #define MAX_RECV_QUEUE_SIZE          4
 
@@ -540,6 +619,23 @@ ndisprotFlushReceiveQueue(
     IN PNDISPROT_OPEN_CONTEXT        pOpenContext
     );
 
+NDIS_STATUS
+ndisprotAllocateReceiveQueues(
+    IN PNDISPROT_OPEN_CONTEXT        pOpenContext
+    );
+
+VOID
+ndisprotFreeReceiveQueues(
+    IN PNDISPROT_OPEN_CONTEXT        pOpenContext
+    );
+
+ULONG
+ndisprotDequeueReceiveNetBufferLists(
+    IN PNDISPROT_OPEN_CONTEXT        pOpenContext,
+    IN ULONG                         MaxCount,
+    IN PLIST_ENTRY                   pRcvList
+    );
+
 _Dispatch_type_(IRP_MJ_WRITE) DRIVER_DISPATCH  NdisprotWrite;
 NTSTATUS
 NdisprotWrite(
@@ -556,6 +652,45 @@ NdisprotCancelWrite(
 
 PROTOCOL_SEND_NET_BUFFER_LISTS_COMPLETE NdisprotSendComplete;
 
+NTSTATUS
+ndisprotRegisterBuffers(
+    IN PNDISPROT_OPEN_CONTEXT       pOpenContext,
+    _In_reads_bytes_(InputLength) IN PNDISPROT_REGISTER_BUFFERS pRegister,
+    IN ULONG                        InputLength
+    );
+
+NTSTATUS
+ndisprotUnregisterBuffers(
+    IN PNDISPROT_OPEN_CONTEXT       pOpenContext
+    );
+
+NTSTATUS
+ndisprotWriteBatch(
+    IN PNDISPROT_OPEN_CONTEXT       pOpenContext,
+    IN PIRP                         pIrp
+    );
+
+NTSTATUS
+ndisprotReadBatch(
+    IN PNDISPROT_OPEN_CONTEXT       pOpenContext,
+    IN PIRP                         pIrp,
+    OUT PULONG                      pBytesReturned
+    );
+
+VOID
+ndisprotCompleteBatchRead(
+    IN PNDISPROT_OPEN_CONTEXT       pOpenContext,
+    IN PIRP                         pIrp,
+    IN PLIST_ENTRY                  pRcvList
+    );
+
+VOID
+ndisprotCompleteBatchSend(
+    IN PNDISPROT_OPEN_CONTEXT       pOpenContext,
+    IN PNET_BUFFER_LIST             pNetBufferList,
+    IN BOOLEAN                      DispatchLevel
+    );
+
 VOID
 ndisprotRestart(
     IN PNDISPROT_OPEN_CONTEXT             pOpenContext,
@@ -468,6 +468,11 @@ Return Value:
         // Clean up the receive packet queue
         //
         ndisprotFlushReceiveQueue(pOpenContext);
+        //
+        // Release any registered buffer, waiting for batched sends
+        // from it to complete.
+        //
+        (VOID)ndisprotUnregisterBuffers(pOpenContext);
     }
 
     NtStatus = STATUS_SUCCESS;
@@ -636,6 +641,70 @@ Return Value:
                 NtStatus = STATUS_DEVICE_NOT_CONNECTED;
             }
             break;
+
+        case IOCTL_NDISPROT_REGISTER_BUFFERS:
+
+            NPROT_ASSERT((FunctionCode & 0x3) == METHOD_BUFFERED);
+            if (pOpenContext != NULL)
+            {
+                NtStatus = ndisprotRegisterBuffers(
+                            pOpenContext,
+                            pIrp->AssociatedIrp.SystemBuffer,
+                            pIrpSp->Parameters.DeviceIoControl.InputBufferLength
+                            );
+            }
+            else
+            {
+                NtStatus = STATUS_DEVICE_NOT_CONNECTED;
+            }
+            break;
+
+        case IOCTL_NDISPROT_UNREGISTER_BUFFERS:
+
+            NPROT_ASSERT((FunctionCode & 0x3) == METHOD_BUFFERED);
+            if (pOpenContext != NULL)
+            {
+                NtStatus = ndisprotUnregisterBuffers(pOpenContext);
+            }
+            else
+            {
+                NtStatus = STATUS_DEVICE_NOT_CONNECTED;
+            }
+            break;
+
+        case IOCTL_NDISPROT_WRITE_BATCH:
+
+            NPROT_ASSERT((FunctionCode & 0x3) == METHOD_BUFFERED);
+            if (pOpenContext != NULL)
+            {
+                //
+                //  On success the IRP is pended, and completed when the
+                //  last frame in the batch has been sent.
+                //
+                NtStatus = ndisprotWriteBatch(pOpenContext, pIrp);
+            }
+            else
+            {
+                NtStatus = STATUS_DEVICE_NOT_CONNECTED;
+            }
+            break;
+
+        case IOCTL_NDISPROT_READ_BATCH:
+
+            NPROT_ASSERT((FunctionCode & 0x3) == METHOD_BUFFERED);
+            if (pOpenContext != NULL)
+            {
+                //
+                //  Pended if nothing has been received yet, and then
+                //  completed by ndisprotServiceReads.
+                //
+                NtStatus = ndisprotReadBatch(pOpenContext, pIrp, &BytesReturned);
+            }
+            else
+            {
+                NtStatus = STATUS_DEVICE_NOT_CONNECTED;
+            }
+            break;
                         
         default:
 
@@ -869,6 +938,7 @@ Return Value:
         //
         //  Free it.
         //
+        ndisprotFreeReceiveQueues(pOpenContext);
         NPROT_FREE_MEM(pOpenContext);
     }
 }
@@ -43,6 +43,18 @@ Revision History:
 #define IOCTL_NDISPROT_BIND_WAIT   \
             _NDISPROT_CTL_CODE(0x204, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
 
+#define IOCTL_NDISPROT_REGISTER_BUFFERS   \
+            _NDISPROT_CTL_CODE(0x206, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+
+#define IOCTL_NDISPROT_UNREGISTER_BUFFERS   \
+            _NDISPROT_CTL_CODE(0x207, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+
+#define IOCTL_NDISPROT_WRITE_BATCH   \
+            _NDISPROT_CTL_CODE(0x208, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+
+#define IOCTL_NDISPROT_READ_BATCH   \
+            _NDISPROT_CTL_CODE(0x209, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+
 
 
 
@@ -87,6 +99,60 @@ typedef struct _NDISPROT_QUERY_BINDING
     ULONG            DeviceDescrLength;    // in bytes
 
 } NDISPROT_QUERY_BINDING, *PNDISPROT_QUERY_BINDING;
+
+
+//
+//  Structure to go with IOCTL_NDISPROT_REGISTER_BUFFERS.
+//  The buffer is divided into SlotCount slots of SlotSize bytes each,
+//  and stays locked in memory until IOCTL_NDISPROT_UNREGISTER_BUFFERS
+//  or until the handle is closed. Only one buffer can be registered
+//  on a handle at a time.
+//
+#define NDISPROT_MAX_REGISTERED_SLOTS    4096
+#define NDISPROT_MAX_REGISTERED_BYTES    (64 * 1024 * 1024)
+
+typedef struct _NDISPROT_REGISTER_BUFFERS
+{
+    ULONGLONG        BufferAddress;
+    ULONG            SlotSize;            // in bytes
+    ULONG            SlotCount;
+
+} NDISPROT_REGISTER_BUFFERS, *PNDISPROT_REGISTER_BUFFERS;
+
+//
+//  One frame in a registered buffer slot.
+//
+typedef struct _NDISPROT_BATCH_FRAME
+{
+    ULONG            Slot;                // 0-based slot number
+    ULONG            Length;              // in bytes
+
+} NDISPROT_BATCH_FRAME, *PNDISPROT_BATCH_FRAME;
+
+//
+//  Structure to go with IOCTL_NDISPROT_WRITE_BATCH and
+//  IOCTL_NDISPROT_READ_BATCH. The Frames part is of variable
+//  length, FrameCount entries.
+//
+//  WRITE_BATCH: the frames are sent as one chain of packets, directly
+//  from the registered buffer. The slots must not be modified until the
+//  request completes, which happens once every frame has been sent.
+//  On output, FrameCount is the number of frames sent successfully.
+//
+//  READ_BATCH: on input, Frames[i].Slot lists the slots that may be
+//  filled. Received frames are copied into these slots in order, and on
+//  output FrameCount is the number of frames copied and Frames[i].Length
+//  their lengths. If no frames are queued, the request waits for the
+//  next ones to arrive, and completes with all that are queued then.
+//
+#define NDISPROT_MAX_BATCH_FRAMES        256
+
+typedef struct _NDISPROT_BATCH
+{
+    ULONG                   FrameCount;
+    NDISPROT_BATCH_FRAME    Frames[1];
+
+} NDISPROT_BATCH, *PNDISPROT_BATCH;
  
 #endif // __NPROTUSER__H
 
@@ -212,7 +212,9 @@ ndisprotServiceReads(
 Routine Description:
 
     Utility routine to copy received data into user buffers and
-    complete READ IRPs.
+    complete READ IRPs. A pended IOCTL_NDISPROT_READ_BATCH takes as many
+    queued packets as it has slots for, and is completed once for all
+    of them.
 
 Arguments:
 
@@ -226,8 +228,12 @@ Return Value:
 {
     PIRP                pIrp = NULL;
     PLIST_ENTRY         pIrpEntry;
+    PIO_STACK_LOCATION  pIrpSp;
     PNET_BUFFER_LIST    pRcvNetBufList;
     PLIST_ENTRY         pRcvNetBufListEntry;
+    LIST_ENTRY          RcvList;
+    ULONG               MaxCount;
+    ULONG               Count;
     PUCHAR              pSrc, pDst;
     ULONG               BytesRemaining; // at pDst
     PMDL                pMdl;
@@ -245,7 +251,7 @@ Return Value:
     NPROT_ACQUIRE_LOCK(&pOpenContext->Lock, FALSE);
 
     while (!NPROT_IS_LIST_EMPTY(&pOpenContext->PendedReads) &&
-           !NPROT_IS_LIST_EMPTY(&pOpenContext->RecvNetBufListQueue))
+           (pOpenContext->RecvNetBufListCount != 0))
     {
         FoundPendingIrp = FALSE;
 
@@ -292,17 +298,40 @@ Return Value:
             break;
         }
         //
-        //  Get the first queued receive packet
+        //  Get the queued receive packets for this IRP: one for a Read,
+        //  up to the number of slots for a batch read. We hold the lock
+        //  and saw a non-zero count, so there is at least one.
         //
-        pRcvNetBufListEntry = pOpenContext->RecvNetBufListQueue.Flink;
-        NPROT_REMOVE_ENTRY_LIST(pRcvNetBufListEntry);
+        pIrpSp = IoGetCurrentIrpStackLocation(pIrp);
+        MaxCount = 1;
+        if (pIrpSp->MajorFunction == IRP_MJ_DEVICE_CONTROL)
+        {
+            MaxCount = ((PNDISPROT_BATCH)pIrp->AssociatedIrp.SystemBuffer)->FrameCount;
+        }
 
-        pOpenContext->RecvNetBufListCount --;
+        NPROT_INIT_LIST_HEAD(&RcvList);
+        Count = ndisprotDequeueReceiveNetBufferLists(pOpenContext, MaxCount, &RcvList);
+        NPROT_ASSERT(Count != 0);
 
         NPROT_RELEASE_LOCK(&pOpenContext->Lock, FALSE);
 
-        NPROT_DEREF_OPEN(pOpenContext);  // Service: dequeue rcv packet
+        while (Count-- != 0)
+        {
+            NPROT_DEREF_OPEN(pOpenContext);  // Service: dequeue rcv packet
+        }
+
+        if (pIrpSp->MajorFunction == IRP_MJ_DEVICE_CONTROL)
+        {
+            ndisprotCompleteBatchRead(pOpenContext, pIrp, &RcvList);
+
+            NPROT_DEREF_OPEN(pOpenContext);    // took out pended Read
+
+            NPROT_ACQUIRE_LOCK(&pOpenContext->Lock, FALSE);
+            pOpenContext->PendedReadCount--;
+            continue;
+        }
 
+        pRcvNetBufListEntry = NPROT_REMOVE_HEAD_LIST(&RcvList);
         pRcvNetBufList = NPROT_RCV_NBL_FROM_LIST_ENTRY(pRcvNetBufListEntry);
         NPROT_ASSERT(pRcvNetBufList != NULL);
         _Analysis_assume_(pRcvNetBufList != NULL);
@@ -438,6 +467,7 @@ Return Value:
     ULONG                   ReturnFlags = 0;
     BOOLEAN                 DispatchLevel;
     BOOLEAN 			NoReadIRP = FALSE;
+    BOOLEAN                 bQueuedReceive = FALSE;
 
     UNREFERENCED_PARAMETER(PortNumber);
     UNREFERENCED_PARAMETER(NumberOfNetBufferLists);
@@ -616,9 +646,11 @@ Return Value:
 
             }
             //
-            //  Queue this up and service any pending Read IRPs.
+            //  Queue this up. Pending Read IRPs are serviced below, once
+            //  for the whole indication.
             //
             ndisprotQueueReceiveNetBufferList(pOpenContext, pNetBufList, DispatchLevel);
+            bQueuedReceive = TRUE;
 
         }
         while (FALSE);
@@ -661,6 +693,21 @@ Return Value:
                                     ReturnFlags);
     }
 
+    //
+    //  Run the receive queue service routine if there are Read IRPs
+    //  to complete. The barrier pairs with the lock that NdisprotRead
+    //  takes to pend an IRP before it services the queues itself, so
+    //  one of us sees both the packet and the IRP.
+    //
+    if (bQueuedReceive)
+    {
+        KeMemoryBarrier();
+
+        if (!NPROT_IS_LIST_EMPTY(&pOpenContext->PendedReads))
+        {
+            ndisprotServiceReads(pOpenContext);
+        }
+    }
 }
 
 
@@ -674,11 +721,16 @@ ndisprotQueueReceiveNetBufferList(
 
 Routine Description:
 
-    Queue up a received net buffer list on the open context structure.
-    If the queue size goes beyond a water mark, discard a Net Buffer list
-    at the head of the queue.
+    Queue up a received net buffer list on the receive queue of the
+    current processor. If that queue grows beyond a water mark, discard
+    the Net Buffer list at its head.
+
+    The caller runs the queue service routine once it has queued all
+    the net buffer lists from an indication.
 
-    Finally, run the queue service routine.
+    The binding state is checked without the open context lock: NDIS
+    doesn't indicate receives on a binding that has finished pausing,
+    and we only go away after that.
 
 Arguments:
 
@@ -692,23 +744,23 @@ Return Value:
 
 --*/
 {
+    PNPROT_RECV_QUEUE  pQueue;
     PLIST_ENTRY        pEnt;
     PLIST_ENTRY        pDiscardEnt;
     PNET_BUFFER_LIST   pDiscardNetBufList;
+    ULONG              MaxQueueSize;
 
     do
     {
 
         NPROT_REF_OPEN(pOpenContext);    // queued rcv net buffer list
 
-        NPROT_ACQUIRE_LOCK(&pOpenContext->Lock, DispatchLevel);
-
         if ((pOpenContext->State == NdisprotPaused)
             || (pOpenContext->State == NdisprotPausing))
         {
-            NPROT_RELEASE_LOCK(&pOpenContext->Lock, DispatchLevel);
-
             ndisprotFreeReceiveNetBufferList(pOpenContext, pRcvNetBufList, DispatchLevel);
+
+            NPROT_DEREF_OPEN(pOpenContext);  // dropped rcv packet - paused
             break;
         }
 
@@ -716,52 +768,54 @@ Return Value:
         //  Check if the binding is in the proper state to receive
         //  this net buffer list.
         //
-        if (NPROT_TEST_FLAGS(pOpenContext->Flags, NPROTO_BIND_FLAGS, NPROTO_BIND_ACTIVE) &&
-            (pOpenContext->PowerState == NetDeviceStateD0))
-        {
-
-            //
-            // Queue the net buffer list
-            //
-            pEnt = NPROT_RCV_NBL_TO_LIST_ENTRY(pRcvNetBufList);
-            NPROT_INSERT_TAIL_LIST(&pOpenContext->RecvNetBufListQueue, pEnt);
-            NPROT_RCV_NBL_FROM_LIST_ENTRY(pEnt) = pRcvNetBufList;
-            pOpenContext->RecvNetBufListCount++;
-
-            DEBUGP(DL_VERY_LOUD, ("QueueReceiveNetBufferList: open %p,"
-                    " queued nbl %p, queue size %d\n",
-                    pOpenContext, pRcvNetBufList, pOpenContext->RecvNetBufListCount));
-
-        }
-        else
+        if (!NPROT_TEST_FLAGS(pOpenContext->Flags, NPROTO_BIND_FLAGS, NPROTO_BIND_ACTIVE) ||
+            (pOpenContext->PowerState != NetDeviceStateD0))
         {
             //
             //  Received this net buffer list when the binding is going away.
             //  Drop this.
             //
-            NPROT_RELEASE_LOCK(&pOpenContext->Lock, DispatchLevel);
-
             ndisprotFreeReceiveNetBufferList(pOpenContext, pRcvNetBufList, DispatchLevel);
 
             NPROT_DEREF_OPEN(pOpenContext);  // dropped rcv packet - bad state
             break;
         }
 
+        MaxQueueSize = (pOpenContext->pRegisteredBuffers != NULL)?
+                            MAX_BATCH_RECV_QUEUE_SIZE: MAX_RECV_QUEUE_SIZE;
+
+        pQueue = &pOpenContext->pRecvQueues[NPROT_CURRENT_PROCESSOR_INDEX() % pOpenContext->RecvQueueCount];
+
+        NPROT_ACQUIRE_LOCK(&pQueue->Lock, DispatchLevel);
+
+        //
+        // Queue the net buffer list
+        //
+        pEnt = NPROT_RCV_NBL_TO_LIST_ENTRY(pRcvNetBufList);
+        NPROT_INSERT_TAIL_LIST(&pQueue->NetBufListQueue, pEnt);
+        NPROT_RCV_NBL_FROM_LIST_ENTRY(pEnt) = pRcvNetBufList;
+        pQueue->NetBufListCount++;
+        NdisInterlockedIncrement(&pOpenContext->RecvNetBufListCount);
+
+        DEBUGP(DL_VERY_LOUD, ("QueueReceiveNetBufferList: open %p,"
+                " queued nbl %p, queue %p size %d\n",
+                pOpenContext, pRcvNetBufList, pQueue, pQueue->NetBufListCount));
 
         //
-        //  Trim the queue if it has grown too big.
+        //  Trim the queue if it has grown too big. Batched reads drain
+        //  many packets at a time, so allow a deeper queue for them.
         //
-        if (pOpenContext->RecvNetBufListCount > MAX_RECV_QUEUE_SIZE)
+        if (pQueue->NetBufListCount > MaxQueueSize)
         {
             //
             //  Remove the head of the queue.
             //
-            pDiscardEnt = pOpenContext->RecvNetBufListQueue.Flink;
-            NPROT_REMOVE_ENTRY_LIST(pDiscardEnt);
+            pDiscardEnt = NPROT_REMOVE_HEAD_LIST(&pQueue->NetBufListQueue);
 
-            pOpenContext->RecvNetBufListCount --;
+            pQueue->NetBufListCount --;
+            NdisInterlockedDecrement(&pOpenContext->RecvNetBufListCount);
 
-            NPROT_RELEASE_LOCK(&pOpenContext->Lock, DispatchLevel);
+            NPROT_RELEASE_LOCK(&pQueue->Lock, DispatchLevel);
 
             pDiscardNetBufList = NPROT_RCV_NBL_FROM_LIST_ENTRY(pDiscardEnt);
 
@@ -777,13 +831,8 @@ Return Value:
         }
         else
         {
-            NPROT_RELEASE_LOCK(&pOpenContext->Lock, DispatchLevel);
+            NPROT_RELEASE_LOCK(&pQueue->Lock, DispatchLevel);
         }
-
-        //
-        //  Run the receive queue service routine now.
-        //
-        ndisprotServiceReads(pOpenContext);
     }
     while (FALSE);
 }
@@ -1081,22 +1130,24 @@ Return Value:
 {
     PLIST_ENTRY         pRcvNetBufListEntry;
     PNET_BUFFER_LIST    pRcvNetBufList;
+    LIST_ENTRY          RcvList;
 
     NPROT_REF_OPEN(pOpenContext);  // temp ref - flushRcvQueue
 
+    NPROT_INIT_LIST_HEAD(&RcvList);
+
     NPROT_ACQUIRE_LOCK(&pOpenContext->Lock, FALSE);
 
-    while (!NPROT_IS_LIST_EMPTY(&pOpenContext->RecvNetBufListQueue))
+    (VOID)ndisprotDequeueReceiveNetBufferLists(pOpenContext, MAXULONG, &RcvList);
+
+    NPROT_RELEASE_LOCK(&pOpenContext->Lock, FALSE);
+
+    while (!NPROT_IS_LIST_EMPTY(&RcvList))
     {
         //
         //  Get the first queued receive packet
         //
-        pRcvNetBufListEntry = pOpenContext->RecvNetBufListQueue.Flink;
-        NPROT_REMOVE_ENTRY_LIST(pRcvNetBufListEntry);
-
-        pOpenContext->RecvNetBufListCount--;
-
-        NPROT_RELEASE_LOCK(&pOpenContext->Lock, FALSE);
+        pRcvNetBufListEntry = NPROT_REMOVE_HEAD_LIST(&RcvList);
 
         pRcvNetBufList = NPROT_RCV_NBL_FROM_LIST_ENTRY(pRcvNetBufListEntry);
         NPROT_RCV_NBL_FROM_LIST_ENTRY(pRcvNetBufListEntry) = NULL;
@@ -1107,13 +1158,174 @@ Return Value:
         ndisprotFreeReceiveNetBufferList(pOpenContext, pRcvNetBufList, FALSE);
 
         NPROT_DEREF_OPEN(pOpenContext);    // took out pended Read
+    }
 
-        NPROT_ACQUIRE_LOCK(&pOpenContext->Lock, FALSE);
+    NPROT_DEREF_OPEN(pOpenContext);    // temp ref - flushRcvQueue
+}
+
+
+ULONG
+ndisprotDequeueReceiveNetBufferLists(
+    IN PNDISPROT_OPEN_CONTEXT        pOpenContext,
+    IN ULONG                         MaxCount,
+    IN PLIST_ENTRY                   pRcvList
+    )
+/*++
+
+Routine Description:
+
+    Move up to MaxCount queued receive packets onto the tail of the
+    given list. The receive queues are visited round robin, starting
+    where the last call stopped, so that a busy processor's queue can't
+    starve the others. Packets from one queue keep their order.
+
+    The caller holds the open context lock, and drops the open reference
+    of each packet as it does for a packet dequeued any other way.
+
+Arguments:
+
+    pOpenContext - pointer to open context
+    MaxCount - most packets to take
+    pRcvList - list to move them to
+
+Return Value:
+
+    The number of packets moved.
+
+--*/
+{
+    PNPROT_RECV_QUEUE   pQueue;
+    PLIST_ENTRY         pEnt;
+    ULONG               Index;
+    ULONG               Visited;
+    ULONG               Count = 0;
+
+    Index = pOpenContext->NextRecvQueue;
+
+    for (Visited = 0;
+         (Visited < pOpenContext->RecvQueueCount) &&
+            (Count < MaxCount) &&
+            (pOpenContext->RecvNetBufListCount != 0);
+         Visited++)
+    {
+        pQueue = &pOpenContext->pRecvQueues[Index];
+
+        NPROT_ACQUIRE_LOCK(&pQueue->Lock, TRUE);
+
+        while ((Count < MaxCount) && !NPROT_IS_LIST_EMPTY(&pQueue->NetBufListQueue))
+        {
+            pEnt = NPROT_REMOVE_HEAD_LIST(&pQueue->NetBufListQueue);
+            pQueue->NetBufListCount--;
+            NdisInterlockedDecrement(&pOpenContext->RecvNetBufListCount);
+
+            NPROT_INSERT_TAIL_LIST(pRcvList, pEnt);
+            Count++;
+        }
+
+        NPROT_RELEASE_LOCK(&pQueue->Lock, TRUE);
+
+        Index = (Index + 1) % pOpenContext->RecvQueueCount;
     }
 
-    NPROT_RELEASE_LOCK(&pOpenContext->Lock, FALSE);
+    pOpenContext->NextRecvQueue = Index;
 
-    NPROT_DEREF_OPEN(pOpenContext);    // temp ref - flushRcvQueue
+    return (Count);
+}
+
+
+NDIS_STATUS
+ndisprotAllocateReceiveQueues(
+    IN PNDISPROT_OPEN_CONTEXT        pOpenContext
+    )
+/*++
+
+Routine Description:
+
+    Allocate and initialize one receive queue per processor, each on
+    its own cache line.
+
+Arguments:
+
+    pOpenContext - pointer to open context
+
+Return Value:
+
+    NDIS_STATUS_SUCCESS or NDIS_STATUS_RESOURCES
+
+--*/
+{
+    ULONG               QueueCount;
+    ULONG               i;
+
+    QueueCount = NPROT_MAX_PROCESSOR_COUNT();
+    if (QueueCount == 0)
+    {
+        QueueCount = 1;
+    }
+
+    NPROT_ALLOC_MEM(pOpenContext->pRecvQueuesBuffer,
+                    QueueCount * sizeof(NPROT_RECV_QUEUE) + SYSTEM_CACHE_ALIGNMENT_SIZE);
+    if (pOpenContext->pRecvQueuesBuffer == NULL)
+    {
+        return (NDIS_STATUS_RESOURCES);
+    }
+
+    pOpenContext->pRecvQueues = (PNPROT_RECV_QUEUE)
+        ALIGN_UP_POINTER_BY(pOpenContext->pRecvQueuesBuffer, SYSTEM_CACHE_ALIGNMENT_SIZE);
+    pOpenContext->RecvQueueCount = QueueCount;
+    pOpenContext->NextRecvQueue = 0;
+    pOpenContext->RecvNetBufListCount = 0;
+
+    NPROT_ZERO_MEM(pOpenContext->pRecvQueues, QueueCount * sizeof(NPROT_RECV_QUEUE));
+
+    for (i = 0; i < QueueCount; i++)
+    {
+        NPROT_INIT_LOCK(&pOpenContext->pRecvQueues[i].Lock);
+        NPROT_INIT_LIST_HEAD(&pOpenContext->pRecvQueues[i].NetBufListQueue);
+    }
+
+    return (NDIS_STATUS_SUCCESS);
+}
+
+
+VOID
+ndisprotFreeReceiveQueues(
+    IN PNDISPROT_OPEN_CONTEXT        pOpenContext
+    )
+/*++
+
+Routine Description:
+
+    Free the receive queues of an open context. They must be empty.
+
+Arguments:
+
+    pOpenContext - pointer to open context
+
+Return Value:
+
+    None
+
+--*/
+{
+    ULONG               i;
+
+    if (pOpenContext->pRecvQueuesBuffer == NULL)
+    {
+        return;
+    }
+
+    NPROT_ASSERT(pOpenContext->RecvNetBufListCount == 0);
+
+    for (i = 0; i < pOpenContext->RecvQueueCount; i++)
+    {
+        NPROT_FREE_LOCK(&pOpenContext->pRecvQueues[i].Lock);
+    }
+
+    NPROT_FREE_MEM(pOpenContext->pRecvQueuesBuffer);
+    pOpenContext->pRecvQueuesBuffer = NULL;
+    pOpenContext->pRecvQueues = NULL;
+    pOpenContext->RecvQueueCount = 0;
 }
 
 
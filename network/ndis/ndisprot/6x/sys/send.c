@@ -190,6 +190,7 @@ Return Value:
         //  when this count goes to zero.
         //
         NPROT_SEND_NBL_RSVD(pNetBufferList)->RefCount = 1;
+        NPROT_SEND_NBL_RSVD(pNetBufferList)->pBatch = NULL;
 
         //
         //  We set up a cancel ID on each send NetBufferList (which maps to a Write IRP), 
@@ -368,7 +369,9 @@ NdisprotSendComplete(
 Routine Description:
 
     NDIS entry point called to signify completion of a packet send.
-    We pick up and complete the Write IRP corresponding to this packet.
+    We pick up and complete the Write IRP corresponding to this packet,
+    or hand the packet to ndisprotCompleteBatchSend if it belongs to a
+    write batch.
 
 Arguments:
 
@@ -402,46 +405,53 @@ Return Value:
         
         pIrp = NPROT_IRP_FROM_SEND_NBL(CurrNetBufferList);
 
-        IoAcquireCancelSpinLock(&pIrp->CancelIrql);
-        IoSetCancelRoutine(pIrp, NULL);
-        pIrp->Tail.Overlay.DriverContext[0] = NULL;
-        pIrp->Tail.Overlay.DriverContext[1] = NULL;
-        IoReleaseCancelSpinLock(pIrp->CancelIrql);
+        if (NPROT_SEND_NBL_RSVD(CurrNetBufferList)->pBatch != NULL)
+        {
+            ndisprotCompleteBatchSend(pOpenContext, CurrNetBufferList, DispatchLevel);
+        }
+        else
+        {
+            IoAcquireCancelSpinLock(&pIrp->CancelIrql);
+            IoSetCancelRoutine(pIrp, NULL);
+            pIrp->Tail.Overlay.DriverContext[0] = NULL;
+            pIrp->Tail.Overlay.DriverContext[1] = NULL;
+            IoReleaseCancelSpinLock(pIrp->CancelIrql);
 
-        NPROT_ACQUIRE_LOCK(&pOpenContext->Lock, DispatchLevel);
+            NPROT_ACQUIRE_LOCK(&pOpenContext->Lock, DispatchLevel);
 
-        NPROT_REMOVE_ENTRY_LIST(&pIrp->Tail.Overlay.ListEntry);
+            NPROT_REMOVE_ENTRY_LIST(&pIrp->Tail.Overlay.ListEntry);
 
-        NPROT_RELEASE_LOCK(&pOpenContext->Lock, DispatchLevel);
+            NPROT_RELEASE_LOCK(&pOpenContext->Lock, DispatchLevel);
         
-        CompletionStatus = NET_BUFFER_LIST_STATUS(CurrNetBufferList);
+            CompletionStatus = NET_BUFFER_LIST_STATUS(CurrNetBufferList);
         
         
-        //
-        //  We are done with the NDIS_PACKET:
-        //
-        NPROT_DEREF_SEND_NBL(CurrNetBufferList, DispatchLevel);
-
-        //
-        //  Complete the Write IRP with the right status.
-        //
-        pIrpSp = IoGetCurrentIrpStackLocation(pIrp);
-        if (CompletionStatus == NDIS_STATUS_SUCCESS)
-        {
-            pIrp->IoStatus.Information = pIrpSp->Parameters.Write.Length;
-            pIrp->IoStatus.Status = STATUS_SUCCESS;
+            //
+            //  We are done with the NDIS_PACKET:
+            //
+            NPROT_DEREF_SEND_NBL(CurrNetBufferList, DispatchLevel);
+
+            //
+            //  Complete the Write IRP with the right status.
+            //
+            pIrpSp = IoGetCurrentIrpStackLocation(pIrp);
+            if (CompletionStatus == NDIS_STATUS_SUCCESS)
+            {
+                pIrp->IoStatus.Information = pIrpSp->Parameters.Write.Length;
+                pIrp->IoStatus.Status = STATUS_SUCCESS;
+            }
+            else
+            {
+                pIrp->IoStatus.Information = 0;
+                pIrp->IoStatus.Status = STATUS_UNSUCCESSFUL;
+            }
+
+            DEBUGP(DL_INFO, ("SendComplete: NetBufferList %p/IRP %p/Length %d "
+                            "completed with status %x\n",
+                            CurrNetBufferList, pIrp, pIrp->IoStatus.Information, pIrp->IoStatus.Status));
+
+            IoCompleteRequest(pIrp, IO_NO_INCREMENT);
         }
-        else
-        {
-            pIrp->IoStatus.Information = 0;
-            pIrp->IoStatus.Status = STATUS_UNSUCCESSFUL;
-        }
-
-        DEBUGP(DL_INFO, ("SendComplete: NetBufferList %p/IRP %p/Length %d "
-                        "completed with status %x\n",
-                        CurrNetBufferList, pIrp, pIrp->IoStatus.Information, pIrp->IoStatus.Status));
-
-        IoCompleteRequest(pIrp, IO_NO_INCREMENT);
 
         NPROT_ACQUIRE_LOCK(&pOpenContext->Lock, DispatchLevel);
         pOpenContext->PendedSendCount--;
@@ -128,6 +128,8 @@ NDIS_OID NICSupportedOids[] =
         OID_RECEIVE_FILTER_FREE_QUEUE,
         OID_RECEIVE_FILTER_CLEAR_FILTER,
         OID_RECEIVE_FILTER_SET_FILTER,
+        OID_GEN_RECEIVE_SCALE_PARAMETERS,
+        OID_GEN_RECEIVE_HASH,
 #endif
 };
 
@@ -171,6 +173,7 @@ Arguments:
 
 #if (NDIS_SUPPORT_NDIS620)
         NDIS_PM_CAPABILITIES PmCapabilities;
+        NDIS_RECEIVE_SCALE_CAPABILITIES RssCapabilities;
 #elif (NDIS_SUPPORT_NDIS6)
         NDIS_PNP_CAPABILITIES PnpCapabilities;
 #endif // NDIS MINIPORT VERSION
@@ -309,6 +312,16 @@ Arguments:
             {
                 break;
             }
+
+            //
+            // If RSS is supported, initialize the receive blocks of the RSS queues.
+            //
+            Status = AllocateRSSQueues(Adapter);
+            if(Status != NDIS_STATUS_SUCCESS)
+            {
+                DEBUGP(MP_ERROR, "[%p] AllocateRSSQueues Status 0x%08x\n", Adapter, Status);
+                break;
+            }
         }
 
         //
@@ -400,6 +413,35 @@ Arguments:
         //
         NIC_COPY_ADDRESS(AdapterGeneral.CurrentMacAddress, Adapter->CurrentAddress);
         AdapterGeneral.RecvScaleCapabilities = NULL;
+
+#if (NDIS_SUPPORT_NDIS620)
+        //
+        // Advertise RSS if it's enabled on the adapter (it's never enabled
+        // together with VMQ).
+        //
+        if(RSS_SUPPORTED(Adapter))
+        {
+            NdisZeroMemory(&RssCapabilities, sizeof(RssCapabilities));
+
+#if (NDIS_SUPPORT_NDIS630)
+            {C_ASSERT(sizeof(RssCapabilities) >= NDIS_SIZEOF_RECEIVE_SCALE_CAPABILITIES_REVISION_2);}
+            RssCapabilities.Header.Type = NDIS_OBJECT_TYPE_RSS_CAPABILITIES;
+            RssCapabilities.Header.Size = NDIS_SIZEOF_RECEIVE_SCALE_CAPABILITIES_REVISION_2;
+            RssCapabilities.Header.Revision = NDIS_RECEIVE_SCALE_CAPABILITIES_REVISION_2;
+            RssCapabilities.NumberOfIndirectionTableEntries = NIC_RSS_MAX_INDIRECTION_TABLE_ENTRIES;
+#else
+            {C_ASSERT(sizeof(RssCapabilities) >= NDIS_SIZEOF_RECEIVE_SCALE_CAPABILITIES_REVISION_1);}
+            RssCapabilities.Header.Type = NDIS_OBJECT_TYPE_RSS_CAPABILITIES;
+            RssCapabilities.Header.Size = NDIS_SIZEOF_RECEIVE_SCALE_CAPABILITIES_REVISION_1;
+            RssCapabilities.Header.Revision = NDIS_RECEIVE_SCALE_CAPABILITIES_REVISION_1;
+#endif
+            RssCapabilities.CapabilitiesFlags = NIC_RSS_CAPABILITIES;
+            RssCapabilities.NumberOfInterruptMessages = NIC_SUPPORTED_NUM_RSS_QUEUES;
+            RssCapabilities.NumberOfReceiveQueues = NIC_SUPPORTED_NUM_RSS_QUEUES;
+
+            AdapterGeneral.RecvScaleCapabilities = &RssCapabilities;
+        }
+#endif
         AdapterGeneral.AccessType = NIC_ACCESS_TYPE;
         AdapterGeneral.DirectionType = NIC_DIRECTION_TYPE;
         AdapterGeneral.ConnectionType = NIC_CONNECTION_TYPE;
@@ -1219,14 +1261,22 @@ Arguments:
         NdisInitializeListHead(&Adapter->FreeTcbList);
         NdisAllocateSpinLock(&Adapter->FreeTcbListLock);
 
-        NdisInitializeListHead(&Adapter->SendWaitList);
-        NdisAllocateSpinLock(&Adapter->SendWaitListLock);
+        for (index = 0; index < NIC_SUPPORTED_NUM_TX_QUEUES; index++)
+        {
+            NdisInitializeListHead(&Adapter->TxQueue[index].SendWaitList);
+            NdisAllocateSpinLock(&Adapter->TxQueue[index].SendWaitListLock);
+            KeInitializeSpinLock(&Adapter->TxQueue[index].SendPathSpinLock);
+            InitializeSListHead(&Adapter->TxQueue[index].FreeTcbStack);
+        }
+
+        for (index = 0; index < NIC_SUPPORTED_NUM_QUEUES; index++)
+        {
+            InitializeSListHead(&Adapter->RcbStack[index].FreeRcbStack);
+        }
 
         NdisInitializeListHead(&Adapter->BusyTcbList);
         NdisAllocateSpinLock(&Adapter->BusyTcbListLock);
 
-        KeInitializeSpinLock(&Adapter->SendPathSpinLock);
-
         //
         // Set the default lookahead buffer size.
         //
@@ -1327,6 +1377,18 @@ Arguments:
             break;
         }
 
+        //
+        // Initialize the basic RSS data for this adapter if supported. The hash key, indirection table, and
+        // RSS queue DPCs are set up later, when the RSS OIDs are called.
+        //
+        Status = AllocateRSSData(Adapter);
+        if (Status != NDIS_STATUS_SUCCESS)
+        {
+            DEBUGP(MP_ERROR, "[%p] AllocateRSSData Status 0x%08x\n", Adapter, Status);
+            Status = NDIS_STATUS_FAILURE;
+            break;
+        }
+
     } while(FALSE);
 
 
@@ -1362,6 +1424,7 @@ Arguments:
 --*/
 {
     PLIST_ENTRY pEntry;
+    ULONG index;
 
     DEBUGP(MP_TRACE, "[%p] ---> NICFreeAdapter\n", Adapter);
 
@@ -1395,6 +1458,23 @@ Arguments:
     //
     if(!VMQ_ENABLED(Adapter))
     {
+        for (index = 0; index < NIC_SUPPORTED_NUM_QUEUES; index++)
+        {
+            PSLIST_ENTRY pStackEntry;
+
+            if (Adapter->RcbStack[index].RcbSteals)
+            {
+                DEBUGP(MP_INFO, "[%p] RCB stack %i: %i RCBs stolen from other stacks.\n", Adapter, index, Adapter->RcbStack[index].RcbSteals);
+            }
+
+            while (NULL != (pStackEntry = InterlockedPopEntrySList(&Adapter->RcbStack[index].FreeRcbStack)))
+            {
+                PRCB Rcb = CONTAINING_RECORD(pStackEntry, RCB, FreeLink);
+                NdisFreeNetBufferList(Rcb->Nbl);
+            }
+            Adapter->RcbStack[index].FreeRcbCount = 0;
+        }
+
         if(Adapter->FreeRcbList.Flink)
         {
             while (NULL != (pEntry = NdisInterlockedRemoveHeadList(
@@ -1441,11 +1521,18 @@ Arguments:
         Adapter->TcbMemoryBlock = NULL;
     }
 
-    ASSERT(Adapter->SendWaitList.Flink && IsListEmpty(&Adapter->SendWaitList));
+    for (index = 0; index < NIC_SUPPORTED_NUM_TX_QUEUES; index++)
+    {
+        if (Adapter->TxQueue[index].TcbSteals)
+        {
+            DEBUGP(MP_INFO, "[%p] Transmit queue %i: %i TCBs stolen from other queues.\n", Adapter, index, Adapter->TxQueue[index].TcbSteals);
+        }
+        ASSERT(Adapter->TxQueue[index].SendWaitList.Flink && IsListEmpty(&Adapter->TxQueue[index].SendWaitList));
+        NdisFreeSpinLock(&Adapter->TxQueue[index].SendWaitListLock);
+    }
     ASSERT(Adapter->BusyTcbList.Flink && IsListEmpty(&Adapter->BusyTcbList));
 
     NdisFreeSpinLock(&Adapter->FreeTcbListLock);
-    NdisFreeSpinLock(&Adapter->SendWaitListLock);
     NdisFreeSpinLock(&Adapter->BusyTcbListLock);
     NdisFreeSpinLock(&Adapter->FreeRcbListLock);
 
@@ -1454,6 +1541,11 @@ Arguments:
     //
     FreeVMQData(Adapter);
 
+    //
+    // Release the RSS queue DPCs and free the remaining RSS related data
+    //
+    FreeRSSData(Adapter);
+
     //
     // Free receive DPCs
     //
@@ -1482,7 +1574,7 @@ NICUpdateDPCMaxIndicateCount(
 Routine Description:
 
     The NICUpdateDPCMaxIndicateCount function updates the maximum amount of NBLs to be indicated per block, based
-    on the number of owned receive blocks.
+    on the number of owned receive blocks and the current interrupt moderation scale.
 
 Arguments:
 
@@ -1496,11 +1588,17 @@ Arguments:
 {
     if(ReceiveDpc->RecvBlockCount)
     {
+        //
+        // A moderated DPC runs less often, so it is allowed to indicate more NBLs per run
+        //
+        ULONG MaxRecvsPerDpc = NIC_MAX_RECVS_PER_DPC +
+            (ReceiveDpc->ModerationScale * (NIC_MAX_RECVS_PER_MODERATED_DPC - NIC_MAX_RECVS_PER_DPC)) / NIC_INTERRUPT_MODERATION_SCALE;
+
         //
         // Update MaxNblCountPerIndicate. Scale back the amount of NBL indications we're allowed to do per
         // consumed receive block so that we don't sepnd too much time in the DPC as the number of queues grows large.
         //
-        ReceiveDpc->MaxNblCountPerIndicate = NIC_MAX_RECVS_PER_DPC/ReceiveDpc->RecvBlockCount;
+        ReceiveDpc->MaxNblCountPerIndicate = MaxRecvsPerDpc/ReceiveDpc->RecvBlockCount;
     }
 
 }
@@ -1608,6 +1706,7 @@ Arguments:
     PMP_ADAPTER_RECEIVE_DPC ReceiveDpc=NULL, ExistingDpc=NULL;
     PLIST_ENTRY ReceiveListEntry;
     NTSTATUS Status = STATUS_SUCCESS;
+    NDIS_TIMER_CHARACTERISTICS Timer;
 
     ASSERT(BlockId <  NIC_SUPPORTED_NUM_QUEUES);
 
@@ -1644,6 +1743,34 @@ Arguments:
             break;
         }
 
+        //
+        // Allocate the timer that queues the DPC when interrupt moderation is holding back receives
+        //
+        NdisZeroMemory(&Timer, sizeof(Timer));
+
+        {C_ASSERT(NDIS_SIZEOF_TIMER_CHARACTERISTICS_REVISION_1 <= sizeof(Timer));}
+        Timer.Header.Type = NDIS_OBJECT_TYPE_TIMER_CHARACTERISTICS;
+        Timer.Header.Size = NDIS_SIZEOF_TIMER_CHARACTERISTICS_REVISION_1;
+        Timer.Header.Revision = NDIS_TIMER_CHARACTERISTICS_REVISION_1;
+
+        Timer.TimerFunction = RXModerationTimerDpc;
+        Timer.FunctionContext = ReceiveDpc;
+        Timer.AllocationTag = NIC_TAG_TIMER;
+
+        Status = NdisAllocateTimerObject(
+                NdisDriverHandle,
+                &Timer,
+                &ReceiveDpc->ModerationTimer);
+        if(Status != NDIS_STATUS_SUCCESS)
+        {
+            DEBUGP(MP_ERROR, "[%p] Could not allocate moderation timer for receive DPC.\n", Adapter);
+            ReceiveDpc->ModerationTimer = NULL;
+            Status = NDIS_STATUS_RESOURCES;
+            break;
+        }
+        ReceiveDpc->ModerationThreshold = 1;
+        ReceiveDpc->ModerationSampleStart = KeQueryInterruptTime();
+
         //
         // Make sure the target DPC list starts getting processed as soon as it's queued even if was queued from
         // another processor.
@@ -1746,9 +1873,20 @@ Arguments:
 --*/
 {
     ASSERT(AdapterDpc->RecvBlockCount==0);
+
+    if(AdapterDpc->Indications)
+    {
+        DEBUGP(MP_INFO, "[%p] Receive DPC on processor %i: %I64u frames in %I64u indications.\n",
+               AdapterDpc->Adapter, AdapterDpc->ProcessorNumber, AdapterDpc->IndicatedFrames, AdapterDpc->Indications);
+    }
+
     //
     // Free DPC dymainc fields and memory
     //
+    if(AdapterDpc->ModerationTimer)
+    {
+         NdisFreeTimerObject(AdapterDpc->ModerationTimer);
+    }
     if(AdapterDpc->WorkItem)
     {
          NdisFreeIoWorkItem(AdapterDpc->WorkItem);
@@ -1981,6 +2119,26 @@ Return Value:
     Adapter->ulLinkSendSpeed = NIC_XMIT_SPEED;
     Adapter->ulLinkRecvSpeed = NIC_RECV_SPEED;
 
+    //
+    // Read the standard *InterruptModeration keyword. Moderation is enabled unless
+    // the keyword is present and set to 0.
+    //
+    {
+        NDIS_STATUS ReadStatus;
+        PNDIS_CONFIGURATION_PARAMETER Parameter = NULL;
+        NDIS_STRING InterruptModerationKeyword = NDIS_STRING_CONST("*InterruptModeration");
+
+        NdisReadConfiguration(
+                &ReadStatus,
+                &Parameter,
+                ConfigurationHandle,
+                &InterruptModerationKeyword,
+                NdisParameterInteger);
+
+        Adapter->InterruptModeration = (ReadStatus != NDIS_STATUS_SUCCESS || Parameter->ParameterData.IntegerData != 0);
+        DEBUGP(MP_INFO, "[%p] Interrupt moderation: %i\n", Adapter, Adapter->InterruptModeration);
+    }
+
     //
     // Read VMQ related configuration parameters
     //
@@ -1992,6 +2150,17 @@ Return Value:
         goto Exit;
     }
 
+    //
+    // Read RSS related configuration parameters (after VMQ, since the two are exclusive)
+    //
+    Status = ReadRSSConfig(ConfigurationHandle, Adapter);
+    if(Status != NDIS_STATUS_SUCCESS)
+    {
+        DEBUGP(MP_ERROR, "[%p] ReadRSSConfig Status = 0x%08x\n", Adapter, Status);
+        Status = NDIS_STATUS_FAILURE;
+        goto Exit;
+    }
+
     //
     // Read NDIS QOS related configuration parameters
     //
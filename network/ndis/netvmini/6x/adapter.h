@@ -66,10 +66,31 @@ typedef struct _MP_ADAPTER_RECEIVE_DPC
 
     //
     // Sets up the maximum amount of NBLs that can be indicated by a single
-    // receive block. This is initially NIC_MAX_RECVS_PER_INDICATE.
+    // receive block. This is initially NIC_MAX_RECVS_PER_INDICATE, and grows
+    // with the interrupt moderation scale.
     //
     ULONG MaxNblCountPerIndicate;
 
+    //
+    // Interrupt moderation state. The DPC is queued once QueuedFrames reaches
+    // ModerationThreshold; until then, ModerationTimer queues it after ModerationDelay.
+    // The scale, threshold and delay are retuned from the receive rate by the DPC.
+    //
+    volatile LONG QueuedFrames;
+    volatile LONG ModerationTimerArmed;
+    NDIS_HANDLE ModerationTimer;
+    ULONG ModerationScale;
+    ULONG ModerationThreshold;
+    ULONG ModerationDelay;
+    ULONG64 ModerationSampleStart;
+    ULONG ModerationSampleFrames;
+
+    //
+    // Frames per indication counters (IndicatedFrames / Indications)
+    //
+    ULONG64 Indications;
+    ULONG64 IndicatedFrames;
+
     //
     // Work item used if we need to avoid DPC timeout
     //
@@ -98,6 +119,45 @@ typedef struct DECLSPEC_CACHEALIGN _MP_ADAPTER_RECEIVE_BLOCK
     volatile LONG PendingReceives;
 } MP_ADAPTER_RECEIVE_BLOCK, * PMP_ADAPTER_RECEIVE_BLOCK;
 
+//
+// This structure is used to track the sends waiting on one of the adapter's transmit queues.
+// Each transmit queue is serviced by at most one CPU at a time, so sends on different queues
+// no longer contend on a single send path lock.
+//
+typedef struct DECLSPEC_CACHEALIGN _MP_ADAPTER_TX_QUEUE
+{
+    //
+    // List of net buffers to send that are waiting for a free TCB
+    //
+    LIST_ENTRY SendWaitList;
+    NDIS_SPIN_LOCK SendWaitListLock;
+
+    //
+    // Spin lock to ensure only one CPU is sending from this queue at a time
+    //
+    KSPIN_LOCK SendPathSpinLock;
+
+    //
+    // Lock-free stack of free TCBs owned by this queue. TcbSteals counts the TCBs this
+    // queue had to take from another queue's stack.
+    //
+    SLIST_HEADER FreeTcbStack;
+    volatile LONG FreeTcbCount;
+    volatile LONG TcbSteals;
+} MP_ADAPTER_TX_QUEUE, * PMP_ADAPTER_TX_QUEUE;
+
+//
+// Lock-free stack of free RCBs from the adapter's (non-VMQ) RCB pool. RCBs are taken from the stack
+// of the receiving processor and go back to the stack they were taken from. RcbSteals counts the
+// RCBs this stack's processors had to take from another stack.
+//
+typedef struct DECLSPEC_CACHEALIGN _MP_ADAPTER_RCB_STACK
+{
+    SLIST_HEADER FreeRcbStack;
+    volatile LONG FreeRcbCount;
+    volatile LONG RcbSteals;
+} MP_ADAPTER_RCB_STACK, * PMP_ADAPTER_RCB_STACK;
+
 //
 // Each adapter managed by this driver has a MP_ADAPTER struct.
 //
@@ -141,13 +201,13 @@ typedef struct _MP_ADAPTER
     // Pool of unused TCBs
     PVOID                   TcbMemoryBlock;
 
-    // List of unused TCBs (sliced out of TcbMemoryBlock)
+    // Shared list of unused TCBs (sliced out of TcbMemoryBlock). Used when a transmit
+    // queue's free TCB stack is empty or full.
     LIST_ENTRY              FreeTcbList;
     NDIS_SPIN_LOCK          FreeTcbListLock;
 
-    // List of net buffers to send that are waiting for a free TCB
-    LIST_ENTRY              SendWaitList;
-    NDIS_SPIN_LOCK          SendWaitListLock;
+    // Transmit queues holding the net buffers that are waiting for a free TCB
+    MP_ADAPTER_TX_QUEUE     TxQueue[NIC_SUPPORTED_NUM_TX_QUEUES];
 
     // List of TCBs that are being read by the NIC hardware
     LIST_ENTRY              BusyTcbList;
@@ -167,9 +227,6 @@ typedef struct _MP_ADAPTER
     // Number of transmit NBLs from the protocol that we still have
     volatile LONG           nBusySend;
 
-    // Spin lock to ensure only one CPU is sending at a time
-    KSPIN_LOCK              SendPathSpinLock;
-
 
     //
     // Receive tracking
@@ -179,10 +236,14 @@ typedef struct _MP_ADAPTER
     // Pool of unused RCBs
     PVOID                   RcbMemoryBlock;
 
-    // List of unused RCBs (sliced out of RcbMemoryBlock)
+    // Shared list of unused RCBs (sliced out of RcbMemoryBlock). Used when a free RCB
+    // stack is empty or full.
     LIST_ENTRY              FreeRcbList;
     NDIS_SPIN_LOCK          FreeRcbListLock;
 
+    // Per-processor stacks of unused RCBs
+    MP_ADAPTER_RCB_STACK    RcbStack[NIC_SUPPORTED_NUM_QUEUES];
+
     NDIS_HANDLE             RecvNblPoolHandle;
 
     //
@@ -211,6 +272,7 @@ typedef struct _MP_ADAPTER
     ULONG64                 ulLinkRecvSpeed;
     ULONG                   ulMaxBusySends;
     ULONG                   ulMaxBusyRecvs;
+    BOOLEAN                 InterruptModeration;
 
     // multicast list
     ULONG                   ulMCListSize;
@@ -266,9 +328,9 @@ typedef struct _MP_ADAPTER
     ULONG                   UnalignedAdapterBufferSize;
 
     //
-    // Tracks any pending NBLs for the particular receiver (either
-    // 0 for non-VMQ scenarios, or the corresponding VMQ queue). These
-    // are consumed by the receive DPCs.
+    // Tracks any pending NBLs for the particular receiver (the corresponding
+    // VMQ queue or RSS queue, or 0 when neither is in use). These are consumed
+    // by the receive DPCs.
     //
     MP_ADAPTER_RECEIVE_BLOCK ReceiveBlock[NIC_SUPPORTED_NUM_QUEUES];
 
@@ -288,6 +350,11 @@ typedef struct _MP_ADAPTER
     //
     MP_ADAPTER_VMQ_DATA     VMQData;
 
+    //
+    // RSS related data
+    //
+    MP_ADAPTER_RSS_DATA     RSSData;
+
 #endif
 
 #if (NDIS_SUPPORT_NDIS630)
@@ -310,6 +377,10 @@ NICAllocReceiveDpc(
     USHORT  ProcessorGroup,
     _In_ _In_range_(0, NIC_SUPPORTED_NUM_QUEUES-1) ULONG BlockId);
 
+VOID
+NICUpdateDPCMaxIndicateCount(
+    _In_ PMP_ADAPTER_RECEIVE_DPC ReceiveDpc);
+
 VOID
 NICReceiveDpcRemoveOwnership(
     _In_ PMP_ADAPTER_RECEIVE_DPC ReceiveDpc,
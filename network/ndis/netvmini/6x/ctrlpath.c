@@ -91,6 +91,18 @@ NICUpdateRxQueue(
     _In_ PMP_ADAPTER        Adapter,
     _In_ PNDIS_OID_REQUEST  NdisSetRequest);
 
+static
+NDIS_STATUS
+NICSetRSSParameters(
+    _In_ PMP_ADAPTER        Adapter,
+    _In_ PNDIS_OID_REQUEST  NdisSetRequest);
+
+static
+NDIS_STATUS
+NICSetReceiveHash(
+    _In_ PMP_ADAPTER        Adapter,
+    _In_ PNDIS_OID_REQUEST  NdisSetRequest);
+
 _IRQL_requires_(PASSIVE_LEVEL)
 static
 NDIS_STATUS
@@ -104,6 +116,8 @@ NICSetQOSParameters(
 #pragma NDIS_PAGEABLE_FUNCTION(NICAllocateRxQueue)
 #pragma NDIS_PAGEABLE_FUNCTION(NICCompleteAllocationRxQueue)
 #pragma NDIS_PAGEABLE_FUNCTION(NICSetRxFilter)
+#pragma NDIS_PAGEABLE_FUNCTION(NICSetRSSParameters)
+#pragma NDIS_PAGEABLE_FUNCTION(NICSetReceiveHash)
 #pragma NDIS_PAGEABLE_FUNCTION(NICSetQOSParameters)
 
 #endif
@@ -711,7 +725,7 @@ Return Value:
             Moderation->Header.Revision = NDIS_INTERRUPT_MODERATION_PARAMETERS_REVISION_1;
             Moderation->Header.Size = NDIS_SIZEOF_INTERRUPT_MODERATION_PARAMETERS_REVISION_1;
             Moderation->Flags = 0;
-            Moderation->InterruptModeration = NdisInterruptModerationNotSupported;
+            Moderation->InterruptModeration = Adapter->InterruptModeration ? NdisInterruptModerationEnabled : NdisInterruptModerationDisabled;
             ulInfoLen = NDIS_SIZEOF_INTERRUPT_MODERATION_PARAMETERS_REVISION_1;
         }
             break;
@@ -720,6 +734,32 @@ Return Value:
             // simply succeed this.
             break;
 
+#if (NDIS_SUPPORT_NDIS620)
+        case OID_GEN_RECEIVE_SCALE_PARAMETERS:
+            //
+            // The RSS parameters are variable length (followed by the indirection table and
+            // the hash key). The RSS code only writes them if they fit, and returns the
+            // length needed either way, so there is nothing left to copy.
+            //
+            Status = QueryRSSParameters(
+                            Adapter,
+                            Query->InformationBuffer,
+                            Query->InformationBufferLength,
+                            &ulInfoLen);
+            break;
+
+        case OID_GEN_RECEIVE_HASH:
+            //
+            // Same as above, the parameters are followed by the hash key.
+            //
+            Status = QueryReceiveHash(
+                            Adapter,
+                            Query->InformationBuffer,
+                            Query->InformationBufferLength,
+                            &ulInfoLen);
+            break;
+#endif
+
         default:
             Status = NDIS_STATUS_NOT_SUPPORTED;
             break;
@@ -836,6 +876,36 @@ Return Value:
             Status = NDIS_STATUS_SUCCESS;
             break;
 
+        case OID_GEN_INTERRUPT_MODERATION:
+        {
+            //
+            // Enable or disable interrupt moderation. The change takes effect right
+            // away, no reset is needed.
+            //
+            PNDIS_INTERRUPT_MODERATION_PARAMETERS Moderation = (PNDIS_INTERRUPT_MODERATION_PARAMETERS)Set->InformationBuffer;
+            if (Set->InformationBufferLength < NDIS_SIZEOF_INTERRUPT_MODERATION_PARAMETERS_REVISION_1)
+            {
+                Set->BytesNeeded = NDIS_SIZEOF_INTERRUPT_MODERATION_PARAMETERS_REVISION_1;
+                Status = NDIS_STATUS_INVALID_LENGTH;
+                break;
+            }
+
+            if (Moderation->Header.Type != NDIS_OBJECT_TYPE_DEFAULT
+                || Moderation->Header.Revision < NDIS_INTERRUPT_MODERATION_PARAMETERS_REVISION_1
+                || (Moderation->InterruptModeration != NdisInterruptModerationEnabled
+                    && Moderation->InterruptModeration != NdisInterruptModerationDisabled))
+            {
+                Status = NDIS_STATUS_INVALID_DATA;
+                break;
+            }
+
+            Adapter->InterruptModeration = (Moderation->InterruptModeration == NdisInterruptModerationEnabled);
+
+            Set->BytesRead = NDIS_SIZEOF_INTERRUPT_MODERATION_PARAMETERS_REVISION_1;
+            Status = NDIS_STATUS_SUCCESS;
+        }
+            break;
+
 #if (NDIS_SUPPORT_NDIS620)
 
         case OID_RECEIVE_FILTER_FREE_QUEUE:
@@ -864,6 +934,24 @@ Return Value:
                             Adapter,
                             NdisSetRequest);             
              break;
+
+        case OID_GEN_RECEIVE_SCALE_PARAMETERS:
+            //
+            // Update the RSS hash key, hash types and indirection table.
+            //
+            Status = NICSetRSSParameters(
+                            Adapter,
+                            NdisSetRequest);
+            break;
+
+        case OID_GEN_RECEIVE_HASH:
+            //
+            // Enable or disable receive hashing (without RSS queue selection).
+            //
+            Status = NICSetReceiveHash(
+                            Adapter,
+                            NdisSetRequest);
+            break;
 #endif
 
         case OID_PNP_SET_POWER:
@@ -1509,6 +1597,136 @@ NICUpdateRxQueue(
 
 }
 
+NDIS_STATUS
+NICSetRSSParameters(
+    _In_ PMP_ADAPTER        Adapter,
+    _In_ PNDIS_OID_REQUEST  NdisSetRequest)
+/*++
+Routine Description:
+
+    This routine will apply the RSS parameters passed in OID_GEN_RECEIVE_SCALE_PARAMETERS. It verifies that the
+    request is well formed, then passes the request to the RSS code, which validates the hash key and indirection
+    table that follow the parameters.
+
+Arguments:
+
+    Adapter         - Pointer to adapter block
+    NdisSetRequest  - The OID data for the request
+
+Return Value:
+
+    NDIS_STATUS
+
+--*/
+{
+    NDIS_STATUS Status = NDIS_STATUS_SUCCESS;
+    struct _SET  *Set = &NdisSetRequest->DATA.SET_INFORMATION;
+    PNDIS_RECEIVE_SCALE_PARAMETERS RssParams = (PNDIS_RECEIVE_SCALE_PARAMETERS)Set->InformationBuffer;
+
+    PAGED_CODE();
+
+    DEBUGP(MP_TRACE, "[%p] ---> NICSetRSSParameters\n", Adapter);
+
+    do
+    {
+        if(!RSS_SUPPORTED(Adapter))
+        {
+            Status = NDIS_STATUS_NOT_SUPPORTED;
+            break;
+        }
+
+        //
+        // Verify that the request matches our requirements. Revision 2 parameters carry 
+        // PROCESSOR_NUMBER indirection table entries.
+        //
+        VERIFY_OID_SET(NdisSetRequest, 
+                       NDIS_OID_REQUEST_REVISION_1, 
+                       NDIS_SIZEOF_RECEIVE_SCALE_PARAMETERS_REVISION_2);
+
+        if(RssParams->Header.Type != NDIS_OBJECT_TYPE_RSS_PARAMETERS
+            ||
+            RssParams->Header.Revision < NDIS_RECEIVE_SCALE_PARAMETERS_REVISION_2)
+        {
+            DEBUGP(MP_ERROR, "[%p] Unsupported RSS parameters type (%i) or revision (%i).\n", Adapter, RssParams->Header.Type, RssParams->Header.Revision);
+            Status = NDIS_STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        //
+        // Ready to apply the parameters
+        //
+        Status = SetRSSParameters(Adapter, RssParams, Set->InformationBufferLength);
+
+    } while(FALSE);
+
+    DEBUGP(MP_TRACE, "[%p] <--- NICSetRSSParameters Status 0x%08x\n", Adapter, Status);
+
+    return Status;
+}
+
+NDIS_STATUS
+NICSetReceiveHash(
+    _In_ PMP_ADAPTER        Adapter,
+    _In_ PNDIS_OID_REQUEST  NdisSetRequest)
+/*++
+Routine Description:
+
+    This routine will apply the receive hash parameters passed in OID_GEN_RECEIVE_HASH. It verifies that the
+    request is well formed, then passes the request to the RSS code.
+
+Arguments:
+
+    Adapter         - Pointer to adapter block
+    NdisSetRequest  - The OID data for the request
+
+Return Value:
+
+    NDIS_STATUS
+
+--*/
+{
+    NDIS_STATUS Status = NDIS_STATUS_SUCCESS;
+    struct _SET  *Set = &NdisSetRequest->DATA.SET_INFORMATION;
+    PNDIS_RECEIVE_HASH_PARAMETERS HashParams = (PNDIS_RECEIVE_HASH_PARAMETERS)Set->InformationBuffer;
+
+    PAGED_CODE();
+
+    DEBUGP(MP_TRACE, "[%p] ---> NICSetReceiveHash\n", Adapter);
+
+    do
+    {
+        if(!RSS_SUPPORTED(Adapter))
+        {
+            Status = NDIS_STATUS_NOT_SUPPORTED;
+            break;
+        }
+
+        //
+        // Verify that the request matches our requirements
+        //
+        VERIFY_OID_SET(NdisSetRequest, 
+                       NDIS_OID_REQUEST_REVISION_1, 
+                       NDIS_SIZEOF_RECEIVE_HASH_PARAMETERS_REVISION_1);
+
+        if(HashParams->Header.Revision < NDIS_RECEIVE_HASH_PARAMETERS_REVISION_1)
+        {
+            DEBUGP(MP_ERROR, "[%p] Unsupported receive hash parameters revision (%i).\n", Adapter, HashParams->Header.Revision);
+            Status = NDIS_STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        //
+        // Ready to apply the parameters
+        //
+        Status = SetReceiveHash(Adapter, HashParams, Set->InformationBufferLength);
+
+    } while(FALSE);
+
+    DEBUGP(MP_TRACE, "[%p] <--- NICSetReceiveHash Status 0x%08x\n", Adapter, Status);
+
+    return Status;
+}
+
 #endif
 
 #if (NDIS_SUPPORT_NDIS630)
@@ -38,16 +38,23 @@ Abstract:
 #include "netvmin6.h"
 #include "datapath.tmh"
 
+static
+ULONG
+TXGetQueueForNetBufferList(
+    _In_  PNET_BUFFER_LIST  NetBufferList);
+
 static
 VOID
 TXQueueNetBufferForSend(
     _In_  PMP_ADAPTER       Adapter,
+    _In_  PMP_ADAPTER_TX_QUEUE TxQueue,
     _In_  PNET_BUFFER       NetBuffer);
 
 static
 VOID
 TXTransmitQueuedSends(
     _In_  PMP_ADAPTER  Adapter,
+    _In_  PMP_ADAPTER_TX_QUEUE TxQueue,
     _In_  BOOLEAN      fAtDispatch);
 
 static
@@ -55,12 +62,21 @@ VOID
 TXScheduleTheSendComplete(
     _In_  PMP_ADAPTER  Adapter);
 
+static
+BOOLEAN
+RXIsFrameAcceptedByAdapter(
+    _In_  PMP_ADAPTER  Adapter,
+    _In_reads_bytes_(NIC_MACADDR_SIZE) PUCHAR DestAddress,
+    _In_  ULONG        FrameType);
+
 static
 VOID
 RXQueueFrameOnAdapter(
     _In_  PMP_ADAPTER  Adapter,
     _In_  PNDIS_NET_BUFFER_LIST_8021Q_INFO Nbl1QInfo,
-    _In_  PFRAME       Frame);
+    _In_  PFRAME       Frame,
+    _In_reads_bytes_(NIC_MACADDR_SIZE) PUCHAR DestAddress,
+    _In_  ULONG        FrameType);
 
 static
 VOID
@@ -140,6 +156,10 @@ Return Value:
     BOOLEAN           fAtDispatch = (SendFlags & NDIS_SEND_FLAGS_DISPATCH_LEVEL) ? TRUE:FALSE;
     NDIS_STATUS       Status;
     ULONG             NumNbls=0;
+    ULONG             TxQueueMask = 0;
+    ULONG             TxQueueId;
+
+    C_ASSERT(NIC_SUPPORTED_NUM_TX_QUEUES <= sizeof(TxQueueMask) * 8);
 
     DEBUGP(MP_TRACE, "[%p] ---> MPSendNetBufferLists\n", Adapter);
 
@@ -176,6 +196,13 @@ Return Value:
         {
             NET_BUFFER_LIST_STATUS(Nbl) = NDIS_STATUS_SUCCESS;
 
+            //
+            // All the NBs of an NBL go out on the same transmit queue, so they
+            // stay in order.
+            //
+            TxQueueId = TXGetQueueForNetBufferList(Nbl);
+            TxQueueMask |= (1UL << TxQueueId);
+
             //
             // Queue each NB for transmission.
             //
@@ -185,7 +212,7 @@ Return Value:
                 NetBuffer = NET_BUFFER_NEXT_NB(NetBuffer))
             {
                 NBL_FROM_SEND_NB(NetBuffer) = Nbl;
-                TXQueueNetBufferForSend(Adapter, NetBuffer);
+                TXQueueNetBufferForSend(Adapter, &Adapter->TxQueue[TxQueueId], NetBuffer);
             }
 
             TXNblRelease(Adapter, Nbl, fAtDispatch);
@@ -224,23 +251,72 @@ Return Value:
     DEBUGP(MP_TRACE, "[%p] %i NBLs processed.\n", Adapter, NumNbls);
 
     //
-    // Now actually go send each of the queued NBs.
+    // Now actually go send each of the queued NBs, on each transmit queue
+    // that we queued to.
     //
-    TXTransmitQueuedSends(Adapter, fAtDispatch);
+    for (TxQueueId = 0; TxQueueMask != 0; TxQueueId++, TxQueueMask >>= 1)
+    {
+        if (TxQueueMask & 1)
+        {
+            TXTransmitQueuedSends(Adapter, &Adapter->TxQueue[TxQueueId], fAtDispatch);
+        }
+    }
 
     DEBUGP(MP_TRACE, "[%p] <--- MPSendNetBufferLists\n", Adapter);
 }
 
+ULONG
+TXGetQueueForNetBufferList(
+    _In_  PNET_BUFFER_LIST  NetBufferList)
+/*++
+
+Routine Description:
+
+    This routine picks the transmit queue for a NET_BUFFER_LIST.
+
+    If the protocol stamped the NBL with an RSS hash, the hash selects the
+    queue, so every send of a connection uses the same transmit queue.
+    Otherwise the current processor selects the queue, so processors sending
+    at the same time rarely share one.
+
+    Runs at IRQL <= DISPATCH_LEVEL
+
+Arguments:
+
+    NetBufferList               NBL to be sent
+
+Return Value:
+
+    Index of the transmit queue.
+
+--*/
+{
+    ULONG HashValue = NET_BUFFER_LIST_GET_HASH_VALUE(NetBufferList);
+
+    if (HashValue == 0)
+    {
+#if (NDIS_SUPPORT_NDIS620)
+        HashValue = KeGetCurrentProcessorNumberEx(NULL);
+#else
+        HashValue = KeGetCurrentProcessorNumber();
+#endif
+    }
+
+    return HashValue % NIC_SUPPORTED_NUM_TX_QUEUES;
+}
+
 VOID
 TXQueueNetBufferForSend(
     _In_  PMP_ADAPTER       Adapter,
+    _In_  PMP_ADAPTER_TX_QUEUE TxQueue,
     _In_  PNET_BUFFER       NetBuffer)
 /*++
 
 Routine Description:
 
-    This routine inserts the NET_BUFFER into the SendWaitList, then calls
-    TXTransmitQueuedSends to start sending data from the list.
+    This routine inserts the NET_BUFFER into the SendWaitList of a transmit
+    queue.  The caller then calls TXTransmitQueuedSends to start sending data
+    from the list.
 
     We use this indirect queue to send data because the miniport should try to
     send frames in the order in which the protocol gave them.  If we just sent
@@ -253,6 +329,7 @@ Routine Description:
 Arguments:
 
     Adapter                     Adapter that is transmitting this NB
+    TxQueue                     Transmit queue that the NB is sent on
     NetBuffer                   NB to be transfered
 
 Return Value:
@@ -297,9 +374,9 @@ Return Value:
             // it's done adding items to the queue.
             //
             NdisInterlockedInsertTailList(
-                    &Adapter->SendWaitList,
+                    &TxQueue->SendWaitList,
                     SEND_WAIT_LIST_FROM_NB(NetBuffer),
-                    &Adapter->SendWaitListLock);
+                    &TxQueue->SendWaitListLock);
         }
 
     } while (FALSE);
@@ -313,12 +390,14 @@ VOID
 #pragma prefast(suppress: 28167, "PREfast does not recognize IRQL is conditionally raised and lowered")
 TXTransmitQueuedSends(
     _In_  PMP_ADAPTER  Adapter,
+    _In_  PMP_ADAPTER_TX_QUEUE TxQueue,
     _In_  BOOLEAN      fAtDispatch)
 /*++
 
 Routine Description:
 
-    This routine sends as many frames from the SendWaitList as it can.
+    This routine sends as many frames from the SendWaitList of a transmit
+    queue as it can.
 
     If there are not enough resources to send immediately, this function stops
     and leaves the remaining frames on the SendWaitList, to be sent once there
@@ -330,6 +409,7 @@ Routine Description:
 Arguments:
 
     Adapter                     Our adapter
+    TxQueue                     Transmit queue to send from
     fAtDispatch                 TRUE if the current IRQL is DISPATCH_LEVEL
 
 Return Value:
@@ -347,9 +427,11 @@ Return Value:
            Adapter);
 
     //
-    // This guard ensures that only one CPU is running this function at a time.
-    // We check this so that items from the SendWaitList get sent to the
-    // receiving adapters in the same order that they were queued.
+    // This guard ensures that only one CPU is running this function at a time
+    // for a given transmit queue.  We check this so that items from the
+    // SendWaitList get sent to the receiving adapters in the same order that
+    // they were queued.  Sends on different transmit queues are not ordered
+    // with respect to each other, and can proceed in parallel.
     //
     // You could remove this guard and everything will still work ok, but some
     // frames might be delivered out-of-order.
@@ -363,11 +445,10 @@ Return Value:
         KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
     }
 
-    if (KeTryToAcquireSpinLockAtDpcLevel(&Adapter->SendPathSpinLock))
+    if (KeTryToAcquireSpinLockAtDpcLevel(&TxQueue->SendPathSpinLock))
     {
         for (NumFramesSent = 0; NumFramesSent < NIC_MAX_SENDS_PER_DPC; NumFramesSent++)
         {
-            PLIST_ENTRY pTcbEntry = NULL;
             PTCB Tcb = NULL;
             PLIST_ENTRY pQueuedSend = NULL;
             PNET_BUFFER NetBuffer;
@@ -375,10 +456,8 @@ Return Value:
             //
             // Get the next available TCB.
             //
-            pTcbEntry = NdisInterlockedRemoveHeadList(
-                    &Adapter->FreeTcbList,
-                    &Adapter->FreeTcbListLock);
-            if (!pTcbEntry)
+            Tcb = GetTCB(Adapter, (ULONG)(TxQueue - Adapter->TxQueue));
+            if (!Tcb)
             {
                 //
                 // The adapter can't handle any more simultaneous transmit
@@ -388,23 +467,18 @@ Return Value:
                 break;
             }
 
-            Tcb = CONTAINING_RECORD(pTcbEntry, TCB, TcbLink);
-
             //
             // Get the next NB that needs sending.
             //
             pQueuedSend = NdisInterlockedRemoveHeadList(
-                    &Adapter->SendWaitList,
-                    &Adapter->SendWaitListLock);
+                    &TxQueue->SendWaitList,
+                    &TxQueue->SendWaitListLock);
             if (!pQueuedSend)
             {
                 //
                 // There's nothing left that needs sending.  We're all done.
                 //
-                NdisInterlockedInsertTailList(
-                        &Adapter->FreeTcbList,
-                        &Tcb->TcbLink,
-                        &Adapter->FreeTcbListLock);
+                ReturnTCB(Adapter, Tcb);
                 break;
             }
 
@@ -428,7 +502,7 @@ Return Value:
             fScheduleTheSendCompleteDpc = TRUE;
         }
 
-        KeReleaseSpinLock(&Adapter->SendPathSpinLock, DISPATCH_LEVEL);
+        KeReleaseSpinLock(&TxQueue->SendPathSpinLock, DISPATCH_LEVEL);
     }
 
     if (!fAtDispatch)
@@ -575,6 +649,7 @@ Routine Description:
 {
     BOOLEAN fRescheduleThisDpcAgain = TRUE;
     ULONG NumFramesSent = 0;
+    ULONG TxQueueId;
 
     DEBUGP(MP_TRACE, "[%p] ---> TXSendComplete.\n", Adapter);
 
@@ -642,7 +717,13 @@ Routine Description:
         ReturnTCB(Adapter, Tcb);
     }
 
-    TXTransmitQueuedSends(Adapter, TRUE);
+    //
+    // TCBs were freed, so restart any transmit queue that ran out of them.
+    //
+    for (TxQueueId = 0; TxQueueId < NIC_SUPPORTED_NUM_TX_QUEUES; TxQueueId++)
+    {
+        TXTransmitQueuedSends(Adapter, &Adapter->TxQueue[TxQueueId], TRUE);
+    }
 
     if (fRescheduleThisDpcAgain)
     {
@@ -897,37 +978,43 @@ Return Value:
 --*/
 {
     PTCB Tcb;
+    ULONG TxQueueId;
 
     DEBUGP(MP_TRACE, "[%p] ---> TXFlushSendQueue Status = 0x%08x\n", Adapter, CompleteStatus);
 
 
     //
-    // First, free anything queued in the driver.
+    // First, free anything queued in the driver, on every transmit queue.
     //
 
-    while (TRUE)
+    for (TxQueueId = 0; TxQueueId < NIC_SUPPORTED_NUM_TX_QUEUES; TxQueueId++)
     {
-        PLIST_ENTRY pEntry;
-        PNET_BUFFER NetBuffer;
-        PNET_BUFFER_LIST NetBufferList;
+        PMP_ADAPTER_TX_QUEUE TxQueue = &Adapter->TxQueue[TxQueueId];
 
-        pEntry = NdisInterlockedRemoveHeadList(
-                &Adapter->SendWaitList,
-                &Adapter->SendWaitListLock);
-
-        if (!pEntry)
+        while (TRUE)
         {
-            // End of list -- nothing left to free.
-            break;
-        }
+            PLIST_ENTRY pEntry;
+            PNET_BUFFER NetBuffer;
+            PNET_BUFFER_LIST NetBufferList;
 
-        NetBuffer = NB_FROM_SEND_WAIT_LIST(pEntry);
-        NetBufferList = NBL_FROM_SEND_NB(NetBuffer);
+            pEntry = NdisInterlockedRemoveHeadList(
+                    &TxQueue->SendWaitList,
+                    &TxQueue->SendWaitListLock);
 
-        DEBUGP(MP_TRACE, "[%p] Dropping Send NB: 0x%p.\n", Adapter, NetBuffer);
+            if (!pEntry)
+            {
+                // End of list -- nothing left to free.
+                break;
+            }
+
+            NetBuffer = NB_FROM_SEND_WAIT_LIST(pEntry);
+            NetBufferList = NBL_FROM_SEND_NB(NetBuffer);
 
-        NET_BUFFER_LIST_STATUS(NetBufferList) = CompleteStatus;
-        TXNblRelease(Adapter, NetBufferList, FALSE);
+            DEBUGP(MP_TRACE, "[%p] Dropping Send NB: 0x%p.\n", Adapter, NetBuffer);
+
+            NET_BUFFER_LIST_STATUS(NetBufferList) = CompleteStatus;
+            TXNblRelease(Adapter, NetBufferList, FALSE);
+        }
     }
 
 
@@ -959,6 +1046,12 @@ Routine Description:
     This routine sends a TCB to each netvmini 6.x adapter (besides the sending
     adapter itself)
 
+    The FRAME is shared by every receiving adapter: each one references it and
+    points its RCB's NET_BUFFER at the FRAME's MDL, so the payload is not copied
+    per receiver.  The only copy happens when a receiving adapter's VMQ filter
+    routes the frame to a queue with its own shared memory.  The frame header
+    is only classified once, here, rather than by every receiver.
+
     Runs at IRQL <= DISPATCH_LEVEL
 
 Arguments:
@@ -976,10 +1069,15 @@ Return Value:
 {
     MP_LOCK_STATE  LockState;
     PLIST_ENTRY AdapterLink;
+    UCHAR DestAddress[NIC_MACADDR_SIZE];
+    ULONG FrameType;
 
 
     DEBUGP(MP_TRACE, "[%p] ---> RXDeliverFrameToEveryAdapter. Frame=0x%p\n", SendAdapter, Frame);
 
+    GET_DESTINATION_OF_FRAME(DestAddress, Frame->Data);
+    FrameType = NICGetFrameTypeFromDestination(DestAddress);
+
     LOCK_ADAPTER_LIST_FOR_READ(&LockState, fAtDispatch ? NDIS_RWL_AT_DISPATCH_LEVEL:0);
     UNREFERENCED_PARAMETER(fAtDispatch);
 
@@ -1004,7 +1102,7 @@ Return Value:
             continue;
         }
 
-        RXQueueFrameOnAdapter(DestAdapter, Nbl1QInfo, Frame);
+        RXQueueFrameOnAdapter(DestAdapter, Nbl1QInfo, Frame, DestAddress, FrameType);
     }
 
     UNLOCK_ADAPTER_LIST(&LockState);
@@ -1013,11 +1111,109 @@ Return Value:
 
 }
 
+BOOLEAN
+RXIsFrameWantedByAnyAdapter(
+    _In_  PMP_ADAPTER  SendAdapter,
+    _In_reads_bytes_(NIC_MACADDR_SIZE) PUCHAR DestAddress,
+    _In_  BOOLEAN      fAtDispatch)
+/*++
+
+Routine Description:
+
+    This routine checks whether any netvmini 6.x adapter (besides the sending
+    adapter itself) would receive a frame sent to DestAddress.  The send path
+    uses it to skip copying the frame off the wire when nobody is listening.
+
+    An adapter that joins or changes its packet filter right after this check
+    simply misses the frame, as it would have if the frame had been sent a
+    moment earlier.
+
+    Runs at IRQL <= DISPATCH_LEVEL
+
+Arguments:
+
+    SendAdapter                 Our adapter that is doing the sending
+    DestAddress                 Destination address of the frame
+    fAtDispatch                 TRUE if the current IRQL is DISPATCH_LEVEL
+
+Return Value:
+
+    TRUE if at least one other adapter accepts the frame.
+
+--*/
+{
+    MP_LOCK_STATE  LockState;
+    PLIST_ENTRY AdapterLink;
+    ULONG FrameType = NICGetFrameTypeFromDestination(DestAddress);
+    BOOLEAN Wanted = FALSE;
+
+    LOCK_ADAPTER_LIST_FOR_READ(&LockState, fAtDispatch ? NDIS_RWL_AT_DISPATCH_LEVEL:0);
+    UNREFERENCED_PARAMETER(fAtDispatch);
+
+    for (
+        AdapterLink = GlobalData.AdapterList.Flink;
+        AdapterLink != &GlobalData.AdapterList && !Wanted;
+        AdapterLink = AdapterLink->Flink
+        )
+    {
+        PMP_ADAPTER DestAdapter = CONTAINING_RECORD(AdapterLink, MP_ADAPTER, List);
+
+        if (DestAdapter != SendAdapter && MP_IS_READY(DestAdapter))
+        {
+            Wanted = RXIsFrameAcceptedByAdapter(DestAdapter, DestAddress, FrameType);
+        }
+    }
+
+    UNLOCK_ADAPTER_LIST(&LockState);
+
+    return Wanted;
+}
+
+static
+BOOLEAN
+RXIsFrameAcceptedByAdapter(
+    _In_  PMP_ADAPTER  Adapter,
+    _In_reads_bytes_(NIC_MACADDR_SIZE) PUCHAR DestAddress,
+    _In_  ULONG        FrameType)
+/*++
+
+Routine Description:
+
+    This routine runs a frame's destination through the receiving adapter's
+    packet filter.
+
+    Runs at IRQL <= DISPATCH_LEVEL
+
+Arguments:
+
+    Adapter                     Pointer to the destination adapter
+    DestAddress                 Destination address of the frame
+    FrameType                   NDIS_PACKET_TYPE_* of the destination address
+
+Return Value:
+
+    TRUE if the adapter may receive the frame.
+
+--*/
+{
+    if(VMQ_ENABLED(Adapter) && FrameType == NDIS_PACKET_TYPE_DIRECTED)
+    {
+        //
+        // Defer decision whether to drop until we check for VMQ matches
+        //
+        return TRUE;
+    }
+
+    return HWIsFrameAcceptedByPacketFilter(Adapter, DestAddress, FrameType);
+}
+
 VOID
 RXQueueFrameOnAdapter(
     _In_  PMP_ADAPTER  Adapter,
     _In_  PNDIS_NET_BUFFER_LIST_8021Q_INFO Nbl1QInfo,
-    _In_  PFRAME       Frame)
+    _In_  PFRAME       Frame,
+    _In_reads_bytes_(NIC_MACADDR_SIZE) PUCHAR DestAddress,
+    _In_  ULONG        FrameType)
 /*++
 
 Routine Description:
@@ -1033,6 +1229,8 @@ Arguments:
     Adapter                     Pointer to the destination adapter
     Nbl1QInfo                   8021Q Tag information for the FRAME to be sent
     Frame                       Pointer to FRAME that contains the data payload
+    DestAddress                 Destination address of the frame
+    FrameType                   NDIS_PACKET_TYPE_* of the destination address
 
 
 Return Value:
@@ -1046,8 +1244,6 @@ Return Value:
     do
     {
         PRCB          Rcb;
-        UCHAR         DestAddress[NIC_MACADDR_SIZE];
-        ULONG         FrameType;
 
 
         if (!MP_IS_READY(Adapter))
@@ -1067,16 +1263,7 @@ Return Value:
             break;
         }
 
-        GET_DESTINATION_OF_FRAME(DestAddress, Frame->Data);
-        FrameType = NICGetFrameTypeFromDestination(DestAddress);
-
-        if(VMQ_ENABLED(Adapter) && FrameType == NDIS_PACKET_TYPE_DIRECTED)
-        {
-            //
-            // Defer decision whether to drop until we check for VMQ matches
-            //
-        }
-        else if (!HWIsFrameAcceptedByPacketFilter(Adapter, DestAddress, FrameType))
+        if (!RXIsFrameAcceptedByAdapter(Adapter, DestAddress, FrameType))
         {
             //
             // Our NIC "hardware" has a packet filter that eliminates frames
@@ -1117,8 +1304,9 @@ Return Value:
 
 
         //
-        // If VMQ is enabled, queue Rcb on the owner VMQ, otherwise
-        // use global receive wait list
+        // If VMQ is enabled, queue Rcb on the owner VMQ. If RSS or receive
+        // hashing is enabled, hash the frame and queue Rcb on the RSS queue
+        // the hash selects. Otherwise use global receive wait list
         //
         if(VMQ_ENABLED(Adapter))
         {
@@ -1126,6 +1314,14 @@ Return Value:
             // Queue on owner VMQ receive block
             //
             AddPendingRcbToRxQueue(Adapter, Rcb);
+            RXScheduleTheReceiveIndication(Adapter, Rcb);
+        }
+        else if(RSS_HASH_ENABLED(Adapter))
+        {
+            //
+            // Queue on the RSS queue's receive block, and schedule that queue's DPC
+            //
+            AddPendingRcbToRssQueue(Adapter, Frame, Rcb);
         }
         else
         {
@@ -1133,10 +1329,9 @@ Return Value:
             // Queue on global receive block
             //
             NdisInterlockedInsertTailList(&Adapter->ReceiveBlock[0].ReceiveList, &Rcb->RcbLink, &Adapter->ReceiveBlock[0].ReceiveListLock);
+            RXScheduleTheReceiveIndication(Adapter, Rcb);
         }
 
-        RXScheduleTheReceiveIndication(Adapter, Rcb);
-
 
     } while (FALSE);
 
@@ -1182,6 +1377,35 @@ Return Value:
         UNREFERENCED_PARAMETER(Rcb);
     }
 
+    RXScheduleReceiveDpc(Adapter, AdapterDpc);
+}
+
+VOID
+RXScheduleReceiveDpc(
+    _In_     PMP_ADAPTER  Adapter,
+    _In_     PMP_ADAPTER_RECEIVE_DPC AdapterDpc)
+/*++
+
+Routine Description:
+
+    This function queues a receive DPC, unless its work item is already
+    pending.
+
+    With interrupt moderation, the DPC is only queued once enough receives
+    are pending for it; otherwise the moderation timer is armed so that the
+    pending receives are indicated after the moderation delay at the latest.
+
+Arguments:
+
+    Adapter                     Pointer to the adapter that is receiving frames
+    AdapterDpc                  The receive DPC to queue
+
+Return Value:
+
+    None.
+
+--*/
+{
     //
     // Schedule DPC
     //
@@ -1193,6 +1417,20 @@ Return Value:
         //
         DEBUGP(MP_TRACE, "[%p] Receive DPC not scheduled, receive work item is pending. Processor: %i\n", Adapter, AdapterDpc->ProcessorNumber);
     }
+    else if(Adapter->InterruptModeration
+            && (ULONG)InterlockedIncrement(&AdapterDpc->QueuedFrames) < AdapterDpc->ModerationThreshold)
+    {
+        //
+        // Moderated: hold the interrupt until more receives are pending, or the moderation delay expires
+        //
+        if(!InterlockedExchange(&AdapterDpc->ModerationTimerArmed, TRUE))
+        {
+            LARGE_INTEGER liDelay;
+            liDelay.QuadPart = -(LONGLONG)AdapterDpc->ModerationDelay;
+            NdisSetTimerObject(AdapterDpc->ModerationTimer, liDelay, 0, NULL);
+        }
+        DEBUGP(MP_TRACE, "[%p] Receive DPC moderated. Processor: %i\n", Adapter, AdapterDpc->ProcessorNumber);
+    }
     else
     {
         KeInsertQueueDpc(&AdapterDpc->Dpc, AdapterDpc, NULL);
@@ -1239,6 +1477,126 @@ Return Value:
     RXReceiveIndicate((PMP_ADAPTER)DeferredContext, (PMP_ADAPTER_RECEIVE_DPC)SystemArgument1, TRUE);
 }
 
+_Use_decl_annotations_
+VOID
+RXModerationTimerDpc(
+    PVOID             SystemSpecific1,
+    PVOID             FunctionContext,
+    PVOID             SystemSpecific2,
+    PVOID             SystemSpecific3)
+/*++
+
+Routine Description:
+
+    Timer function for interrupt moderation. Queues the receive DPC for the
+    receives that interrupt moderation held back.
+
+Arguments:
+
+    FunctionContext             PMP_ADAPTER_RECEIVE_DPC structure for the DPC to queue
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PMP_ADAPTER_RECEIVE_DPC AdapterDpc = (PMP_ADAPTER_RECEIVE_DPC)FunctionContext;
+
+    UNREFERENCED_PARAMETER(SystemSpecific1);
+    UNREFERENCED_PARAMETER(SystemSpecific2);
+    UNREFERENCED_PARAMETER(SystemSpecific3);
+
+    ASSERT(AdapterDpc != NULL);
+    _Analysis_assume_(AdapterDpc != NULL);
+
+    //
+    // Disarm before queueing the DPC, so that a receive that finds the timer armed is
+    // guaranteed to be picked up by this DPC
+    //
+    InterlockedExchange(&AdapterDpc->ModerationTimerArmed, FALSE);
+
+    if(!AdapterDpc->WorkItemQueued)
+    {
+        KeInsertQueueDpc(&AdapterDpc->Dpc, AdapterDpc, NULL);
+    }
+}
+
+static
+VOID
+RXUpdateInterruptModeration(
+    _In_ PMP_ADAPTER_RECEIVE_DPC AdapterDpc,
+    ULONG NumNblsIndicated)
+/*++
+
+Routine Description:
+
+    This function retunes the interrupt moderation of a receive DPC from the
+    receive rate. Once per sampling interval, the rate is mapped linearly onto
+    the moderation scale between the low and high rate watermarks, and the
+    scale sets the pending receive threshold, the moderation delay, and the
+    indication batch size.
+
+    Only called by the DPC (or its work item), so the sampling state is not
+    shared.
+
+Arguments:
+
+    AdapterDpc          PMP_ADAPTER_RECEIVE_DPC structure for this receive
+    NumNblsIndicated    Number of NBLs indicated by this run of the DPC
+
+Return Value:
+
+    None.
+
+--*/
+{
+    ULONG64 Now = KeQueryInterruptTime();
+    ULONG64 Elapsed = Now - AdapterDpc->ModerationSampleStart;
+    ULONG64 Rate;
+    ULONG Scale;
+
+    AdapterDpc->ModerationSampleFrames += NumNblsIndicated;
+
+    if(Elapsed < NIC_INTERRUPT_MODERATION_INTERVAL)
+    {
+        return;
+    }
+
+    //
+    // Frames per sampling interval
+    //
+    Rate = ((ULONG64)AdapterDpc->ModerationSampleFrames * NIC_INTERRUPT_MODERATION_INTERVAL) / Elapsed;
+
+    if(Rate <= NIC_INTERRUPT_MODERATION_LOW_RATE)
+    {
+        Scale = 0;
+    }
+    else if(Rate >= NIC_INTERRUPT_MODERATION_HIGH_RATE)
+    {
+        Scale = NIC_INTERRUPT_MODERATION_SCALE;
+    }
+    else
+    {
+        Scale = (ULONG)(((Rate - NIC_INTERRUPT_MODERATION_LOW_RATE) * NIC_INTERRUPT_MODERATION_SCALE)
+                        / (NIC_INTERRUPT_MODERATION_HIGH_RATE - NIC_INTERRUPT_MODERATION_LOW_RATE));
+    }
+
+    if(Scale != AdapterDpc->ModerationScale)
+    {
+        AdapterDpc->ModerationScale = Scale;
+        AdapterDpc->ModerationThreshold = 1 + (Scale * (NIC_MAX_INTERRUPT_MODERATION_FRAMES - 1)) / NIC_INTERRUPT_MODERATION_SCALE;
+        AdapterDpc->ModerationDelay = (Scale * NIC_MAX_INTERRUPT_MODERATION_DELAY) / NIC_INTERRUPT_MODERATION_SCALE;
+        NICUpdateDPCMaxIndicateCount(AdapterDpc);
+
+        DEBUGP(MP_TRACE, "[%p] Receive DPC moderation retuned. Processor: %i, Rate: %I64u, Threshold: %i, Delay: %i\n",
+               AdapterDpc->Adapter, AdapterDpc->ProcessorNumber, Rate, AdapterDpc->ModerationThreshold, AdapterDpc->ModerationDelay);
+    }
+
+    AdapterDpc->ModerationSampleStart = Now;
+    AdapterDpc->ModerationSampleFrames = 0;
+}
+
 _Use_decl_annotations_
 VOID
 RXReceiveIndicateWorkItem(
@@ -1299,7 +1657,7 @@ Return Value:
 
 {
 
-    ULONG NumNblsReceived = 0;
+    ULONG NumNblsReceived = 0, TotalNblsReceived = 0;
     PNET_BUFFER_LIST FirstNbl = NULL, LastNbl = NULL;
     USHORT CurrentQueue;
 
@@ -1317,6 +1675,11 @@ Return Value:
         return;
     }
 
+    //
+    // Every receive queued so far is about to be consumed, restart the moderation count
+    //
+    InterlockedExchange(&AdapterDpc->QueuedFrames, 0);
+
     for(CurrentQueue = 0; CurrentQueue <NIC_SUPPORTED_NUM_QUEUES; ++CurrentQueue)
     {
         //
@@ -1376,6 +1739,10 @@ Return Value:
             {
                 DEBUGP(MP_TRACE, "[%p] Receive Block %i: %i frames indicated.\n", Adapter, CurrentQueue, NumNblsReceived);
 
+                AdapterDpc->Indications++;
+                AdapterDpc->IndicatedFrames += NumNblsReceived;
+                TotalNblsReceived += NumNblsReceived;
+
                 NET_BUFFER_LIST_NEXT_NBL(LastNbl) = NULL;
 
                 //
@@ -1394,7 +1761,7 @@ Return Value:
                         | NDIS_RECEIVE_FLAGS_PERFECT_FILTERED
 #if (NDIS_SUPPORT_NDIS620)
                         | NDIS_RECEIVE_FLAGS_SINGLE_QUEUE
-                        | (CurrentQueue?NDIS_RECEIVE_FLAGS_SHARED_MEMORY_INFO_VALID:0) //non-default queues use shared memory
+                        | ((VMQ_ENABLED(Adapter) && CurrentQueue)?NDIS_RECEIVE_FLAGS_SHARED_MEMORY_INFO_VALID:0) //non-default VMQ queues use shared memory
 #endif
                         );
             }
@@ -1420,6 +1787,11 @@ Return Value:
 
     }
 
+    if(Adapter->InterruptModeration)
+    {
+        RXUpdateInterruptModeration(AdapterDpc, TotalNblsReceived);
+    }
+
     DEBUGP(MP_TRACE, "[%p] <--- RXReceiveIndicate. Processor: %i\n", Adapter, AdapterDpc->ProcessorNumber);
 }
 
@@ -1495,9 +1867,9 @@ Return Value:
     DEBUGP(MP_TRACE, "[%p] ---> RXFlushReceiveQueue\n", Adapter);
 
     //
-    // If VMQ enabled, then flush the receive queues for this DPC
+    // If VMQ or RSS enabled, then flush the receive queues for this DPC
     //
-    if(VMQ_ENABLED(Adapter))
+    if(VMQ_ENABLED(Adapter) || RSS_SUPPORTED(Adapter))
     {
         USHORT index;
         for(index =0; index < NIC_SUPPORTED_NUM_QUEUES; index++)
@@ -1559,7 +1931,7 @@ Return Value:
     // This miniport completes its sends quickly, so it isn't strictly
     // neccessary to implement MiniportCancelSend.
     //
-    // If we did implement it, we'd have to walk the Adapter->SendWaitList
+    // If we did implement it, we'd have to walk the SendWaitList of every Adapter->TxQueue
     // and look for any NB that points to a NBL where the CancelId matches
     // NDIS_GET_NET_BUFFER_LIST_CANCEL_ID(Nbl).  For any NB that so matches,
     // we'd remove the NB from the SendWaitList and set the NBL's status to
@@ -1655,6 +2027,8 @@ Return Value:
          ReceiveListEntry = ReceiveListEntry->Flink)
     {
         PMP_ADAPTER_RECEIVE_DPC ReceiveDpc = CONTAINING_RECORD(ReceiveListEntry, MP_ADAPTER_RECEIVE_DPC, Entry);
+        NdisCancelTimerObject(ReceiveDpc->ModerationTimer);
+        InterlockedExchange(&ReceiveDpc->ModerationTimerArmed, FALSE);
         KeRemoveQueueDpc(&ReceiveDpc->Dpc);
     }
 
@@ -44,6 +44,8 @@ NDIS_TIMER_FUNCTION TXSendCompleteDpc;
 
 KDEFERRED_ROUTINE RXReceiveIndicateDpc;
 
+NDIS_TIMER_FUNCTION RXModerationTimerDpc;
+
 VOID
 RXDeliverFrameToEveryAdapter(
     _In_  PMP_ADAPTER  SendAdapter,
@@ -51,6 +53,17 @@ RXDeliverFrameToEveryAdapter(
     _In_  PFRAME       Frame,
     _In_  BOOLEAN      fAtDispatch);
 
+BOOLEAN
+RXIsFrameWantedByAnyAdapter(
+    _In_  PMP_ADAPTER  SendAdapter,
+    _In_reads_bytes_(NIC_MACADDR_SIZE) PUCHAR DestAddress,
+    _In_  BOOLEAN      fAtDispatch);
+
+VOID
+RXScheduleReceiveDpc(
+    _In_ PMP_ADAPTER Adapter,
+    _In_ PMP_ADAPTER_RECEIVE_DPC AdapterDpc);
+
 VOID
 RXFlushReceiveQueue(
     _In_ PMP_ADAPTER Adapter,
@@ -134,6 +134,27 @@ C_ASSERT(sizeof(NIC_FRAME_HEADER) == HW_FRAME_HEADER_SIZE);
 //
 #define NIC_MAX_RECVS_PER_DPC              64
 
+//
+// Interrupt moderation (*InterruptModeration). The receive rate is sampled every
+// NIC_INTERRUPT_MODERATION_INTERVAL. Below the low rate every receive fires the
+// receive DPC right away; towards the high rate the DPC waits for up to
+// NIC_MAX_INTERRUPT_MODERATION_FRAMES pending receives or for the moderation
+// delay, and may indicate up to NIC_MAX_RECVS_PER_MODERATED_DPC receives.
+// Rates are in frames per sampling interval, times are in 100ns units.
+//
+#define NIC_INTERRUPT_MODERATION_INTERVAL   100000      // 10ms
+#define NIC_INTERRUPT_MODERATION_LOW_RATE   100         // 10,000 frames/s
+#define NIC_INTERRUPT_MODERATION_HIGH_RATE  1000        // 100,000 frames/s
+#define NIC_MAX_INTERRUPT_MODERATION_FRAMES 32
+#define NIC_MAX_INTERRUPT_MODERATION_DELAY  1000        // 100us
+#define NIC_MAX_RECVS_PER_MODERATED_DPC     128
+
+//
+// Moderation scale is a fixed point fraction: 0 is unmoderated, NIC_INTERRUPT_MODERATION_SCALE
+// is fully moderated
+//
+#define NIC_INTERRUPT_MODERATION_SCALE      256
+
 #define NIC_MAX_LOOKAHEAD                  HW_FRAME_MAX_DATA_SIZE
 #define NIC_BUFFER_SIZE                    HW_MAX_FRAME_SIZE
 
@@ -257,6 +278,36 @@ C_ASSERT(sizeof(NIC_FRAME_HEADER) == HW_FRAME_HEADER_SIZE);
 //
 #define NIC_MIN_BUSY_RECVS 64
 
+//
+// RSS hardware information
+//
+
+//
+// The NIC computes a Toeplitz hash over the IPv4/IPv6 addresses (and TCP ports) of each received frame
+// and uses it to pick one of its receive queues. Each RSS queue is backed by one of the receive blocks,
+// so it cannot have more RSS queues than receive blocks. Queue 0 is the default queue and is always
+// serviced by the default receive DPC.
+//
+#define NIC_SUPPORTED_NUM_RSS_QUEUES NIC_SUPPORTED_NUM_QUEUES
+
+//
+// Largest indirection table (in entries) and secret key (in bytes) that the hash engine can hold. 
+//
+#define NIC_RSS_MAX_INDIRECTION_TABLE_ENTRIES 128
+#define NIC_RSS_MAX_HASH_KEY_SIZE NDIS_RSS_HASH_SECRET_KEY_MAX_SIZE_REVISION_1
+
+#define NIC_RSS_CAPABILITIES (\
+                NDIS_RSS_CAPS_CLASSIFICATION_AT_DPC  | \
+                NDIS_RSS_CAPS_HASH_TYPE_TCP_IPV4     | \
+                NDIS_RSS_CAPS_HASH_TYPE_TCP_IPV6     | \
+                NdisHashFunctionToeplitz)
+
+#define NIC_RSS_SUPPORTED_HASH_TYPES (\
+                NDIS_HASH_IPV4      | \
+                NDIS_HASH_TCP_IPV4  | \
+                NDIS_HASH_IPV6      | \
+                NDIS_HASH_TCP_IPV6)
+
 #else
 
 //
@@ -266,6 +317,20 @@ C_ASSERT(sizeof(NIC_FRAME_HEADER) == HW_FRAME_HEADER_SIZE);
 
 #endif
 
+//
+// Number of hardware transmit queues. Transmit and receive queues come in pairs, so an NBL is sent on the
+// queue that matches its RSS hash (or the current processor when it has none). Ordering is only preserved
+// within a transmit queue.
+//
+#define NIC_SUPPORTED_NUM_TX_QUEUES NIC_SUPPORTED_NUM_QUEUES
+
+//
+// Each transmit queue (and each processor slot, for receives) keeps a lock-free stack of free TCBs (RCBs).
+// A stack holds at most twice its fair share of the pool, the rest overflows to the shared pool.
+//
+#define NIC_MAX_FREE_TCBS_PER_QUEUE ((2 * NIC_MAX_BUSY_SENDS) / NIC_SUPPORTED_NUM_TX_QUEUES)
+#define NIC_MAX_FREE_RCBS_PER_QUEUE ((2 * NIC_MAX_BUSY_RECVS) / NIC_SUPPORTED_NUM_QUEUES)
+
 #if (NDIS_SUPPORT_NDIS630)
 
 //
@@ -586,6 +586,10 @@ DbgPrintOidName(
         MAKECASE(OID_RECEIVE_FILTER_ALLOCATE_QUEUE)
         MAKECASE(OID_RECEIVE_FILTER_QUEUE_ALLOCATION_COMPLETE)
         MAKECASE(OID_RECEIVE_FILTER_SET_FILTER)
+
+        /* RSS OIDs */
+        MAKECASE(OID_GEN_RECEIVE_SCALE_PARAMETERS)
+        MAKECASE(OID_GEN_RECEIVE_HASH)
 #endif
 
 #if (NDIS_SUPPORT_NDIS630)
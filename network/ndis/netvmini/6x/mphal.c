@@ -758,7 +758,9 @@ Routine Description:
     anymore.
 
     Our hardware, of course, doesn't have any DMA, so it just copies the data
-    to a FRAME structure and transmits that.
+    to a FRAME structure and transmits that.  The copy is skipped if no other
+    adapter on the hub would receive the frame; the frame still counts as sent.
+    Receiving adapters share the FRAME rather than copying it again.
 
 
     Runs at IRQL <= DISPATCH_LEVEL
@@ -776,10 +778,11 @@ Return Value:
 
 --*/
 {
-    PFRAME Frame;
+    PFRAME Frame = NULL;
     NDIS_NET_BUFFER_LIST_8021Q_INFO Nbl1QInfo = {0};
     PNET_BUFFER_LIST Nbl = NULL;
     NDIS_STATUS Status = NDIS_STATUS_SUCCESS;
+    UCHAR DestAddress[NIC_MACADDR_SIZE];
 
     DEBUGP(MP_TRACE, "[%p] ---> HWProgramDmaForSend. NB: 0x%p\n", Adapter, NetBuffer);
 
@@ -793,6 +796,19 @@ Return Value:
         Tcb->NetBuffer = NetBuffer;
         Tcb->BytesActuallySent = 0;
 
+        //
+        // Only the frame header is needed to tell whether anyone on the hub
+        // wants this frame.  If nobody does, the frame goes out on the wire
+        // and is lost, so don't bother copying it into a FRAME.
+        //
+        if (HWGetDestinationAddress(NetBuffer, DestAddress) == NDIS_STATUS_SUCCESS
+            && !RXIsFrameWantedByAnyAdapter(Adapter, DestAddress, fAtDispatch))
+        {
+            DEBUGP(MP_TRACE, "[%p] No adapter accepts the frame, dropping it on the wire.\n", Adapter);
+            Tcb->BytesActuallySent = max(min(NET_BUFFER_DATA_LENGTH(NetBuffer), NIC_BUFFER_SIZE), HW_MIN_FRAME_SIZE);
+            break;
+        }
+
         Frame = (PFRAME)NdisAllocateFromNPagedLookasideList(&GlobalData.FrameDataLookaside);
 
         if (!Frame)
@@ -962,6 +978,13 @@ Return Value:
             NET_BUFFER_LIST_INFO(Rcb->Nbl, Ieee8021QNetBufferListInfo) = 0;
         }
 
+        //
+        // Clear any RSS hash left over from the RCB's last receive. If RSS or receive
+        // hashing is enabled, the hash is filled in when the frame is queued. 
+        //
+        NET_BUFFER_LIST_INFO(Rcb->Nbl, NetBufferListHashValue) = 0;
+        NET_BUFFER_LIST_INFO(Rcb->Nbl, NetBufferListHashInfo) = 0;
+
         //
         // If VMQ is enabled, and we're not using the default queue, 
         // we need to copy the FRAME to the NBL's shared memory area
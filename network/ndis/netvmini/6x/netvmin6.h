@@ -32,6 +32,7 @@ _Analysis_mode_(_Analysis_code_type_kernel_driver_);
 #include "hardware.h"
 #include "miniport.h"
 #include "vmq.h"
+#include "rss.h"
 #include "qos.h"
 #include "adapter.h"
 #include "mphal.h"
@@ -0,0 +1,1003 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    Rss.c
+
+Abstract:
+
+   This module implements the RSS related functionality for the adapter. The "hardware" computes
+   a Toeplitz hash for each received IPv4/IPv6 frame, and the indirection table maps the hash to
+   one of the RSS queues. Each RSS queue has its own receive block, consumed by a receive DPC that
+   targets the processor named in the indirection table.
+
+--*/
+
+#include "netvmin6.h"
+#include "rss.tmh"
+
+#define RSS_ETHERTYPE_IPV4          0x0800
+#define RSS_ETHERTYPE_IPV6          0x86DD
+#define RSS_IPPROTO_TCP             6
+
+#define RSS_IPV4_HEADER_SIZE        20
+#define RSS_IPV6_HEADER_SIZE        40
+
+//
+// Largest hash input: IPv6 source and destination addresses, followed by the TCP ports
+//
+#define RSS_MAX_HASH_INPUT_SIZE     36
+
+C_ASSERT(NIC_SUPPORTED_NUM_RSS_QUEUES > 1);
+C_ASSERT(NIC_SUPPORTED_NUM_RSS_QUEUES <= NIC_SUPPORTED_NUM_QUEUES);
+C_ASSERT(NIC_SUPPORTED_NUM_RSS_QUEUES <= MAXUCHAR);
+
+static
+ULONG
+RSSComputeToeplitzHash(
+    _In_reads_bytes_(KeySize) PUCHAR Key,
+    ULONG KeySize,
+    _In_reads_bytes_(InputLength) PUCHAR Input,
+    ULONG InputLength)
+/*++
+Routine Description:
+
+    This routine computes the Toeplitz hash of the input. For every bit set in the input, the 32 bits of
+    the key that start at that bit's position are XORed into the result. The key is walked through a
+    64 bit window whose top 32 bits are the current key bits, refilled a byte at a time. Key bytes past
+    the end of the key count as zero.
+
+Arguments:
+
+    Key                     - Secret hash key
+    KeySize                 - Size of the key in bytes
+    Input                   - Bytes to hash
+    InputLength             - Number of bytes to hash
+
+Return Value:
+
+    The hash value
+
+--*/
+{
+    ULONG64 KeyWindow = 0;
+    ULONG Result = 0;
+    ULONG i, Bit;
+
+    for(i = 0; i < sizeof(KeyWindow); i++)
+    {
+        KeyWindow = (KeyWindow << 8) | ((i < KeySize) ? Key[i] : 0);
+    }
+
+    for(i = 0; i < InputLength; i++)
+    {
+        for(Bit = 0; Bit < 8; Bit++)
+        {
+            if(Input[i] & (0x80 >> Bit))
+            {
+                Result ^= (ULONG)(KeyWindow >> 32);
+            }
+            KeyWindow <<= 1;
+        }
+
+        //
+        // The window moved a whole byte, so its low byte is free for the next key byte
+        //
+        KeyWindow |= (i + sizeof(KeyWindow) < KeySize) ? Key[i + sizeof(KeyWindow)] : 0;
+    }
+
+    return Result;
+}
+
+static
+ULONG
+RSSHashFrame(
+    _In_ PMP_ADAPTER_HASH_CONFIG HashConfig,
+    _In_ PFRAME Frame,
+    _Out_ PULONG HashValue)
+/*++
+Routine Description:
+
+    This routine parses the IP header of a received frame and hashes it with the passed in hash
+    configuration. A TCP hash type is only used for unfragmented TCP segments; other IP packets use
+    the IP-only hash type, if it's enabled. IPv6 extension headers are not parsed.
+
+Arguments:
+
+    HashConfig              - Hash function, types and key to use
+    Frame                   - The received frame
+    HashValue               - Set to the hash value, or 0 if the frame was not hashed
+
+Return Value:
+
+    The NDIS_HASH_* type used for the hash, or 0 if the frame was not hashed.
+
+--*/
+{
+    PNIC_FRAME_HEADER Header = (PNIC_FRAME_HEADER)Frame->Data;
+    PUCHAR Ip = Frame->Data + HW_FRAME_HEADER_SIZE;
+    ULONG HashTypes = NDIS_RSS_HASH_TYPE_FROM_HASH_INFO(HashConfig->HashInformation);
+    ULONG HashType = 0;
+    ULONG IpLength;
+    ULONG InputLength = 0;
+    UCHAR Input[RSS_MAX_HASH_INPUT_SIZE];
+    USHORT EtherType;
+
+    *HashValue = 0;
+
+    if(Frame->ulSize <= HW_FRAME_HEADER_SIZE)
+    {
+        return 0;
+    }
+
+    IpLength = Frame->ulSize - HW_FRAME_HEADER_SIZE;
+    EtherType = (USHORT)((Header->EtherType[0] << 8) | Header->EtherType[1]);
+
+    if(EtherType == RSS_ETHERTYPE_IPV4 && IpLength >= RSS_IPV4_HEADER_SIZE)
+    {
+        ULONG IpHeaderLength = (Ip[0] & 0x0F) * 4;
+        BOOLEAN Fragment = ((Ip[6] & 0x3F) | Ip[7]) != 0;   // More fragments flag or fragment offset
+
+        if((Ip[0] >> 4) != 4 || IpHeaderLength < RSS_IPV4_HEADER_SIZE || IpHeaderLength > IpLength)
+        {
+            return 0;
+        }
+
+        //
+        // Source and destination addresses
+        //
+        NdisMoveMemory(Input, Ip + 12, 8);
+        InputLength = 8;
+
+        if((HashTypes & NDIS_HASH_TCP_IPV4)
+            && Ip[9] == RSS_IPPROTO_TCP
+            && !Fragment
+            && IpLength >= IpHeaderLength + 4)
+        {
+            //
+            // Source and destination ports
+            //
+            NdisMoveMemory(Input + InputLength, Ip + IpHeaderLength, 4);
+            InputLength += 4;
+            HashType = NDIS_HASH_TCP_IPV4;
+        }
+        else if(HashTypes & NDIS_HASH_IPV4)
+        {
+            HashType = NDIS_HASH_IPV4;
+        }
+    }
+    else if(EtherType == RSS_ETHERTYPE_IPV6 && IpLength >= RSS_IPV6_HEADER_SIZE)
+    {
+        if((Ip[0] >> 4) != 6)
+        {
+            return 0;
+        }
+
+        //
+        // Source and destination addresses
+        //
+        NdisMoveMemory(Input, Ip + 8, 32);
+        InputLength = 32;
+
+        if((HashTypes & NDIS_HASH_TCP_IPV6)
+            && Ip[6] == RSS_IPPROTO_TCP
+            && IpLength >= RSS_IPV6_HEADER_SIZE + 4)
+        {
+            //
+            // Source and destination ports
+            //
+            NdisMoveMemory(Input + InputLength, Ip + RSS_IPV6_HEADER_SIZE, 4);
+            InputLength += 4;
+            HashType = NDIS_HASH_TCP_IPV6;
+        }
+        else if(HashTypes & NDIS_HASH_IPV6)
+        {
+            HashType = NDIS_HASH_IPV6;
+        }
+    }
+
+    if(HashType)
+    {
+        *HashValue = RSSComputeToeplitzHash(
+                            HashConfig->HashSecretKey,
+                            HashConfig->HashSecretKeySize,
+                            Input,
+                            InputLength);
+    }
+
+    return HashType;
+}
+
+static
+BOOLEAN
+RSSValidHashInformation(
+    ULONG HashInformation)
+/*++
+Routine Description:
+
+    This routine checks that the requested hash function and hash types are supported by the hardware.
+
+--*/
+{
+    ULONG HashFunction = NDIS_RSS_HASH_FUNC_FROM_HASH_INFO(HashInformation);
+    ULONG HashTypes = NDIS_RSS_HASH_TYPE_FROM_HASH_INFO(HashInformation);
+
+    return (BOOLEAN)(HashFunction == NdisHashFunctionToeplitz
+                     && HashTypes != 0
+                     && (HashTypes & ~NIC_RSS_SUPPORTED_HASH_TYPES) == 0);
+}
+
+static
+BOOLEAN
+RSSValidBufferRange(
+    ULONG BufferLength,
+    ULONG Offset,
+    ULONG Size)
+/*++
+Routine Description:
+
+    This routine checks that Size bytes at Offset fit in an OID buffer of BufferLength bytes.
+
+--*/
+{
+    return (BOOLEAN)(Offset <= BufferLength && Size <= BufferLength - Offset);
+}
+
+NDIS_STATUS
+AllocateRSSData(
+    _Inout_ struct _MP_ADAPTER *Adapter)
+/*++
+Routine Description:
+
+    This routine will initialize the basic fields necessary for a MP_ADAPTER_RSS_DATA structure. The function
+    should be called during adapter initialization, before the RSS configuration is read.
+
+    Runs at IRQL = PASSIVE_LEVEL.
+
+Arguments:
+
+    Adapter         - Pointer to our adapter
+
+Return Value:
+
+    NDIS_STATUS
+
+--*/
+{
+    PMP_ADAPTER_RSS_DATA RSSData = &Adapter->RSSData;
+
+    DEBUGP(MP_TRACE, "[%p] ---> AllocateRSSData\n", Adapter);
+
+    NdisZeroMemory(RSSData, sizeof(MP_ADAPTER_RSS_DATA));
+
+    RSSData->RssLock = NdisAllocateRWLock(Adapter->AdapterHandle);
+    if(!RSSData->RssLock)
+    {
+        DEBUGP(MP_ERROR, "[%p] NdisAllocateRWLock failed for the RSS lock.\n", Adapter);
+        return NDIS_STATUS_RESOURCES;
+    }
+
+    DEBUGP(MP_TRACE, "[%p] <--- AllocateRSSData\n", Adapter);
+
+    return NDIS_STATUS_SUCCESS;
+}
+
+VOID
+FreeRSSData(
+    _Inout_ struct _MP_ADAPTER *Adapter)
+/*++
+Routine Description:
+
+    This routine releases the receive DPCs of the RSS queues and frees the RSS lock. The DPCs themselves
+    are freed with the rest of the adapter's receive DPCs.
+
+    Runs at IRQL = PASSIVE_LEVEL.
+
+Arguments:
+
+    Adapter         - Pointer to our adapter
+
+Return Value:
+
+    None
+
+--*/
+{
+    PMP_ADAPTER_RSS_DATA RSSData = &Adapter->RSSData;
+    ULONG QueueId;
+
+    DEBUGP(MP_TRACE, "[%p] ---> FreeRSSData\n", Adapter);
+
+    //
+    // Queue 0 is serviced by the default receive DPC, which is released by the caller
+    //
+    for(QueueId = 1; QueueId < NIC_SUPPORTED_NUM_RSS_QUEUES; ++QueueId)
+    {
+        if(RSSData->QueueDpc[QueueId])
+        {
+            NICReceiveDpcRemoveOwnership(RSSData->QueueDpc[QueueId], QueueId);
+            RSSData->QueueDpc[QueueId] = NULL;
+        }
+    }
+    RSSData->QueueDpc[0] = NULL;
+
+    if(RSSData->RssLock)
+    {
+        NdisFreeRWLock(RSSData->RssLock);
+        RSSData->RssLock = NULL;
+    }
+
+    DEBUGP(MP_TRACE, "[%p] <--- FreeRSSData\n", Adapter);
+}
+
+NDIS_STATUS
+ReadRSSConfig(
+    _In_ NDIS_HANDLE ConfigurationHandle,
+    _Inout_ struct _MP_ADAPTER *Adapter)
+/*++
+Routine Description:
+
+    This routine will read the RSS configuration from the NDIS registry, and set the result in the RSSData
+    flags field. RSS and VMQ cannot be active simultaneously, so RSS is only supported when VMQ is disabled.
+
+Arguments:
+
+    ConfigurationHandle     - Adapter configuration handle
+    Adapter                 - Pointer to our adapter
+
+Return Value:
+
+    NDIS_STATUS
+
+--*/
+{
+    NDIS_STATUS Status = NDIS_STATUS_SUCCESS;
+    PNDIS_CONFIGURATION_PARAMETER Parameter = NULL;
+    NDIS_STRING RSSKeyword = NDIS_STRING_CONST("*RSS");
+
+    DEBUGP(MP_TRACE, "[%p] ---> ReadRSSConfig\n", Adapter);
+
+    do
+    {
+        if(VMQ_ENABLED(Adapter))
+        {
+            DEBUGP(MP_INFO, "[%p] VMQ is enabled, RSS will not be supported.\n", Adapter);
+            break;
+        }
+
+        //
+        // Read the *RSS flag (whether RSS is enabled on the adapter).
+        //
+        NdisReadConfiguration(
+                &Status,
+                &Parameter,
+                ConfigurationHandle,
+                &RSSKeyword,
+                NdisParameterInteger);
+
+        if(Status != NDIS_STATUS_SUCCESS)
+        {
+            DEBUGP(MP_INFO, "[%p] NdisReadConfiguration for *RSS failed Status 0x%08x, defaulting to enabled.\n", Adapter, Status);
+            Status = NDIS_STATUS_SUCCESS;
+            RSS_SET_FLAG(Adapter, fMPRSSD_RSS_SUPPORTED);
+            break;
+        }
+
+        if(Parameter->ParameterData.IntegerData==1)
+        {
+            RSS_SET_FLAG(Adapter, fMPRSSD_RSS_SUPPORTED);
+        }
+
+    } while(FALSE);
+
+    DEBUGP(MP_TRACE, "[%p] <--- ReadRSSConfig Status 0x%08x\n", Adapter, Status);
+
+    return Status;
+}
+
+NDIS_STATUS
+AllocateRSSQueues(
+    _Inout_ struct _MP_ADAPTER *Adapter)
+/*++
+Routine Description:
+
+    This routine initializes the receive blocks of the RSS queues. Queue 0 shares the default receive block
+    and DPC. Until NDIS sets an indirection table, the other queues are also consumed by the default DPC.
+    Should be called after the default receive DPC and receive block are initialized.
+
+    Runs at IRQL = PASSIVE_LEVEL.
+
+Arguments:
+
+    Adapter         - Pointer to our adapter
+
+Return Value:
+
+    NDIS_STATUS
+
+--*/
+{
+    PMP_ADAPTER_RSS_DATA RSSData = &Adapter->RSSData;
+    NDIS_STATUS Status = NDIS_STATUS_SUCCESS;
+    ULONG QueueId;
+
+    DEBUGP(MP_TRACE, "[%p] ---> AllocateRSSQueues\n", Adapter);
+
+    do
+    {
+        if(!RSS_SUPPORTED(Adapter))
+        {
+            break;
+        }
+
+        RSSData->QueueDpc[0] = Adapter->DefaultRecvDpc;
+
+        for(QueueId = 1; QueueId < NIC_SUPPORTED_NUM_RSS_QUEUES; ++QueueId)
+        {
+            Status = NICInitializeReceiveBlock(Adapter, QueueId);
+            if(Status != NDIS_STATUS_SUCCESS)
+            {
+                DEBUGP(MP_ERROR, "[%p] NICInitializeReceiveBlock failed for RSS queue %i. Status 0x%08x\n", Adapter, QueueId, Status);
+                break;
+            }
+
+            //
+            // Matches the default DPC's affinity, so the default DPC is reused
+            //
+            RSSData->QueueDpc[QueueId] = NICAllocReceiveDpc(
+                                                Adapter,
+                                                Adapter->DefaultRecvDpc->ProcessorNumber,
+                                                Adapter->DefaultRecvDpc->ProcessorGroup,
+                                                QueueId);
+            if(!RSSData->QueueDpc[QueueId])
+            {
+                DEBUGP(MP_ERROR, "[%p] Could not allocate receive DPC for RSS queue %i.\n", Adapter, QueueId);
+                Status = NDIS_STATUS_RESOURCES;
+                break;
+            }
+        }
+
+    } while(FALSE);
+
+    DEBUGP(MP_TRACE, "[%p] <--- AllocateRSSQueues Status 0x%08x\n", Adapter, Status);
+
+    return Status;
+}
+
+NDIS_STATUS
+SetRSSParameters(
+    _Inout_ struct _MP_ADAPTER *Adapter,
+    _In_reads_bytes_(ParametersLength) PNDIS_RECEIVE_SCALE_PARAMETERS RssParams,
+    ULONG ParametersLength)
+/*++
+Routine Description:
+
+    This routine applies the RSS parameters from OID_GEN_RECEIVE_SCALE_PARAMETERS.
+
+    Each distinct processor in the indirection table gets its own RSS queue, with a receive DPC that
+    targets that processor. The default DPC's processor always maps to queue 0. If the table names more
+    processors than there are queues, the extra processors share the non-default queues.
+
+    The DPCs are allocated before the new parameters are applied, so a failed allocation leaves the
+    previous configuration in place.
+
+    Runs at IRQL = PASSIVE_LEVEL.
+
+Arguments:
+
+    Adapter             - Pointer to our adapter
+    RssParams           - RSS parameters, followed by the hash key and indirection table
+    ParametersLength    - Size of the OID buffer
+
+Return Value:
+
+    NDIS_STATUS
+
+--*/
+{
+    PMP_ADAPTER_RSS_DATA RSSData = &Adapter->RSSData;
+    NDIS_STATUS Status = NDIS_STATUS_SUCCESS;
+    PMP_ADAPTER_RECEIVE_DPC NewDpc[NIC_SUPPORTED_NUM_RSS_QUEUES] = {0};
+    PMP_ADAPTER_RECEIVE_DPC OldDpc[NIC_SUPPORTED_NUM_RSS_QUEUES] = {0};
+    PROCESSOR_NUMBER QueueProcessor[NIC_SUPPORTED_NUM_RSS_QUEUES] = {0};
+    UCHAR NewQueue[NIC_RSS_MAX_INDIRECTION_TABLE_ENTRIES];
+    PPROCESSOR_NUMBER Table = NULL;
+    ULONG Entries = 0, NumQueues = 1, FoldedProcessors = 0;
+    ULONG i, j, QueueId;
+    BOOLEAN DisableRss;
+    LOCK_STATE_EX LockState;
+
+    DEBUGP(MP_TRACE, "[%p] ---> SetRSSParameters\n", Adapter);
+
+    do
+    {
+        //
+        // A zero hash function also disables RSS
+        //
+        DisableRss = (RssParams->Flags & NDIS_RSS_PARAM_FLAG_DISABLE_RSS)
+                     ||
+                     (!(RssParams->Flags & NDIS_RSS_PARAM_FLAG_HASH_INFO_UNCHANGED)
+                      && NDIS_RSS_HASH_FUNC_FROM_HASH_INFO(RssParams->HashInformation) == 0);
+        if(DisableRss)
+        {
+            break;
+        }
+
+        if(!(RssParams->Flags & NDIS_RSS_PARAM_FLAG_HASH_INFO_UNCHANGED)
+            && !RSSValidHashInformation(RssParams->HashInformation))
+        {
+            DEBUGP(MP_ERROR, "[%p] Unsupported RSS hash information 0x%08x.\n", Adapter, RssParams->HashInformation);
+            Status = NDIS_STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        if(!(RssParams->Flags & NDIS_RSS_PARAM_FLAG_HASH_KEY_UNCHANGED)
+            &&
+            (RssParams->HashSecretKeySize == 0
+             || RssParams->HashSecretKeySize > NIC_RSS_MAX_HASH_KEY_SIZE
+             || !RSSValidBufferRange(ParametersLength, RssParams->HashSecretKeyOffset, RssParams->HashSecretKeySize)))
+        {
+            DEBUGP(MP_ERROR, "[%p] Invalid RSS hash key. Size: %i\n", Adapter, RssParams->HashSecretKeySize);
+            Status = NDIS_STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        if(RssParams->Flags & NDIS_RSS_PARAM_FLAG_ITABLE_UNCHANGED)
+        {
+            break;
+        }
+
+        Entries = RssParams->IndirectionTableSize / sizeof(PROCESSOR_NUMBER);
+        if(RssParams->IndirectionTableSize % sizeof(PROCESSOR_NUMBER)
+            || Entries == 0
+            || Entries > NIC_RSS_MAX_INDIRECTION_TABLE_ENTRIES
+            || (Entries & (Entries - 1)) != 0
+            || !RSSValidBufferRange(ParametersLength, RssParams->IndirectionTableOffset, RssParams->IndirectionTableSize))
+        {
+            DEBUGP(MP_ERROR, "[%p] Invalid RSS indirection table. Size: %i\n", Adapter, RssParams->IndirectionTableSize);
+            Status = NDIS_STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        Table = (PPROCESSOR_NUMBER)((PUCHAR)RssParams + RssParams->IndirectionTableOffset);
+
+        //
+        // Map every indirection table entry to an RSS queue
+        //
+        for(i = 0; i < Entries; ++i)
+        {
+            if(Table[i].Group == Adapter->DefaultRecvDpc->ProcessorGroup
+                && Table[i].Number == Adapter->DefaultRecvDpc->ProcessorNumber)
+            {
+                NewQueue[i] = 0;
+                continue;
+            }
+
+            for(j = 0; j < i; ++j)
+            {
+                if(Table[j].Group == Table[i].Group && Table[j].Number == Table[i].Number)
+                {
+                    break;
+                }
+            }
+
+            if(j < i)
+            {
+                //
+                // Processor already has a queue
+                //
+                NewQueue[i] = NewQueue[j];
+            }
+            else if(NumQueues < NIC_SUPPORTED_NUM_RSS_QUEUES)
+            {
+                QueueProcessor[NumQueues] = Table[i];
+                NewQueue[i] = (UCHAR)NumQueues++;
+            }
+            else
+            {
+                NewQueue[i] = (UCHAR)(1 + (FoldedProcessors++ % (NIC_SUPPORTED_NUM_RSS_QUEUES - 1)));
+            }
+        }
+
+        //
+        // Get the DPC for each queue's processor (if one already exists, it's reused)
+        //
+        for(QueueId = 1; QueueId < NumQueues; ++QueueId)
+        {
+            NewDpc[QueueId] = NICAllocReceiveDpc(Adapter, QueueProcessor[QueueId].Number, QueueProcessor[QueueId].Group, QueueId);
+            if(!NewDpc[QueueId])
+            {
+                DEBUGP(MP_ERROR, "[%p] Could not allocate receive DPC for RSS queue %i, keeping the previous parameters\n", Adapter, QueueId);
+                Status = NDIS_STATUS_RESOURCES;
+                break;
+            }
+        }
+
+        if(Status != NDIS_STATUS_SUCCESS)
+        {
+            //
+            // Undo the ownership the new DPCs took
+            //
+            for(QueueId = 1; QueueId < NumQueues; ++QueueId)
+            {
+                if(NewDpc[QueueId] && NewDpc[QueueId] != RSSData->QueueDpc[QueueId])
+                {
+                    NICReceiveDpcRemoveOwnership(NewDpc[QueueId], QueueId);
+                }
+            }
+        }
+
+    } while(FALSE);
+
+    if(Status != NDIS_STATUS_SUCCESS)
+    {
+        DEBUGP(MP_TRACE, "[%p] <--- SetRSSParameters Status 0x%08x\n", Adapter, Status);
+        return Status;
+    }
+
+    NdisAcquireRWLockWrite(RSSData->RssLock, &LockState, 0);
+
+    if(DisableRss)
+    {
+        DEBUGP(MP_INFO, "[%p] RSS disabled.\n", Adapter);
+        RSS_CLEAR_FLAG(Adapter, fMPRSSD_RSS_ENABLED);
+    }
+    else
+    {
+        if(!(RssParams->Flags & NDIS_RSS_PARAM_FLAG_BASE_CPU_UNCHANGED))
+        {
+            RSSData->BaseCpuNumber = RssParams->BaseCpuNumber;
+        }
+
+        if(!(RssParams->Flags & NDIS_RSS_PARAM_FLAG_HASH_INFO_UNCHANGED))
+        {
+            RSSData->RssHash.HashInformation = RssParams->HashInformation;
+        }
+
+        if(!(RssParams->Flags & NDIS_RSS_PARAM_FLAG_HASH_KEY_UNCHANGED))
+        {
+            NdisMoveMemory(
+                RSSData->RssHash.HashSecretKey,
+                (PUCHAR)RssParams + RssParams->HashSecretKeyOffset,
+                RssParams->HashSecretKeySize);
+            RSSData->RssHash.HashSecretKeySize = RssParams->HashSecretKeySize;
+        }
+
+        if(Table)
+        {
+            NdisMoveMemory(RSSData->IndirectionTable, Table, Entries * sizeof(PROCESSOR_NUMBER));
+            NdisMoveMemory(RSSData->IndirectionQueue, NewQueue, Entries);
+            RSSData->IndirectionTableEntries = (USHORT)Entries;
+
+            for(QueueId = 1; QueueId < NumQueues; ++QueueId)
+            {
+                if(NewDpc[QueueId] != RSSData->QueueDpc[QueueId])
+                {
+                    OldDpc[QueueId] = RSSData->QueueDpc[QueueId];
+                    RSSData->QueueDpc[QueueId] = NewDpc[QueueId];
+                }
+            }
+        }
+
+        DEBUGP(MP_INFO, "[%p] RSS enabled. Hash information: 0x%08x, Entries: %i, Queues: %i\n", Adapter, RSSData->RssHash.HashInformation, RSSData->IndirectionTableEntries, NumQueues);
+        RSS_SET_FLAG(Adapter, fMPRSSD_RSS_ENABLED);
+    }
+
+    NdisReleaseRWLock(RSSData->RssLock, &LockState);
+
+    //
+    // Receives now go to the new DPCs. Update the previous owners, and check whether there are any
+    // pending receives on their queues. If there are, then schedule the new DPC to make sure they are
+    // not lost.
+    //
+    for(QueueId = 1; QueueId < NumQueues; ++QueueId)
+    {
+        if(OldDpc[QueueId])
+        {
+            NICReceiveDpcRemoveOwnership(OldDpc[QueueId], QueueId);
+
+            if(!IsListEmpty(&Adapter->ReceiveBlock[QueueId].ReceiveList))
+            {
+                DEBUGP(MP_INFO, "[%p] Receive Block %i: Receives were pending, queued new DPC.\n", Adapter, QueueId);
+                KeInsertQueueDpc(&RSSData->QueueDpc[QueueId]->Dpc, RSSData->QueueDpc[QueueId], NULL);
+            }
+        }
+    }
+
+    DEBUGP(MP_TRACE, "[%p] <--- SetRSSParameters Status 0x%08x\n", Adapter, Status);
+
+    return Status;
+}
+
+NDIS_STATUS
+QueryRSSParameters(
+    _In_ struct _MP_ADAPTER *Adapter,
+    _Out_writes_bytes_to_opt_(BufferLength, *BytesNeeded) PVOID Buffer,
+    ULONG BufferLength,
+    _Out_ PULONG BytesNeeded)
+/*++
+Routine Description:
+
+    This routine returns the current RSS parameters for OID_GEN_RECEIVE_SCALE_PARAMETERS, followed by
+    the indirection table and the hash key. The result is only written if it fits in the buffer.
+
+    Runs at IRQL = PASSIVE_LEVEL.
+
+Arguments:
+
+    Adapter             - Pointer to our adapter
+    Buffer              - OID buffer
+    BufferLength        - Size of the OID buffer
+    BytesNeeded         - Set to the size of the result
+
+Return Value:
+
+    NDIS_STATUS
+
+--*/
+{
+    PMP_ADAPTER_RSS_DATA RSSData = &Adapter->RSSData;
+    PNDIS_RECEIVE_SCALE_PARAMETERS RssParams = (PNDIS_RECEIVE_SCALE_PARAMETERS)Buffer;
+    ULONG TableSize;
+    LOCK_STATE_EX LockState;
+
+    *BytesNeeded = 0;
+
+    if(!RSS_SUPPORTED(Adapter))
+    {
+        return NDIS_STATUS_NOT_SUPPORTED;
+    }
+
+    NdisAcquireRWLockRead(RSSData->RssLock, &LockState, 0);
+
+    TableSize = RSSData->IndirectionTableEntries * sizeof(PROCESSOR_NUMBER);
+    *BytesNeeded = NDIS_SIZEOF_RECEIVE_SCALE_PARAMETERS_REVISION_2 + TableSize + RSSData->RssHash.HashSecretKeySize;
+
+    if(RssParams && BufferLength >= *BytesNeeded)
+    {
+        NdisZeroMemory(RssParams, NDIS_SIZEOF_RECEIVE_SCALE_PARAMETERS_REVISION_2);
+        RssParams->Header.Type = NDIS_OBJECT_TYPE_RSS_PARAMETERS;
+        RssParams->Header.Revision = NDIS_RECEIVE_SCALE_PARAMETERS_REVISION_2;
+        RssParams->Header.Size = NDIS_SIZEOF_RECEIVE_SCALE_PARAMETERS_REVISION_2;
+
+        RssParams->Flags = RSS_ENABLED(Adapter) ? 0 : NDIS_RSS_PARAM_FLAG_DISABLE_RSS;
+        RssParams->BaseCpuNumber = RSSData->BaseCpuNumber;
+        RssParams->HashInformation = RSSData->RssHash.HashInformation;
+
+        RssParams->IndirectionTableSize = (USHORT)TableSize;
+        RssParams->IndirectionTableOffset = NDIS_SIZEOF_RECEIVE_SCALE_PARAMETERS_REVISION_2;
+        NdisMoveMemory((PUCHAR)RssParams + RssParams->IndirectionTableOffset, RSSData->IndirectionTable, TableSize);
+
+        RssParams->HashSecretKeySize = RSSData->RssHash.HashSecretKeySize;
+        RssParams->HashSecretKeyOffset = RssParams->IndirectionTableOffset + TableSize;
+        NdisMoveMemory((PUCHAR)RssParams + RssParams->HashSecretKeyOffset, RSSData->RssHash.HashSecretKey, RSSData->RssHash.HashSecretKeySize);
+    }
+
+    NdisReleaseRWLock(RSSData->RssLock, &LockState);
+
+    return NDIS_STATUS_SUCCESS;
+}
+
+NDIS_STATUS
+SetReceiveHash(
+    _Inout_ struct _MP_ADAPTER *Adapter,
+    _In_reads_bytes_(ParametersLength) PNDIS_RECEIVE_HASH_PARAMETERS HashParams,
+    ULONG ParametersLength)
+/*++
+Routine Description:
+
+    This routine applies the receive hash parameters from OID_GEN_RECEIVE_HASH. With receive hashing
+    enabled (and RSS disabled) frames are hashed, but all of them are indicated on the default queue.
+
+    Runs at IRQL = PASSIVE_LEVEL.
+
+Arguments:
+
+    Adapter             - Pointer to our adapter
+    HashParams          - Receive hash parameters, followed by the hash key
+    ParametersLength    - Size of the OID buffer
+
+Return Value:
+
+    NDIS_STATUS
+
+--*/
+{
+    PMP_ADAPTER_RSS_DATA RSSData = &Adapter->RSSData;
+    BOOLEAN EnableHash = (HashParams->Flags & NDIS_RECEIVE_HASH_FLAG_ENABLE_HASH) ? TRUE : FALSE;
+    LOCK_STATE_EX LockState;
+
+    DEBUGP(MP_TRACE, "[%p] ---> SetReceiveHash\n", Adapter);
+
+    if(EnableHash)
+    {
+        if(!(HashParams->Flags & NDIS_RECEIVE_HASH_FLAG_HASH_INFO_UNCHANGED)
+            && !RSSValidHashInformation(HashParams->HashInformation))
+        {
+            DEBUGP(MP_ERROR, "[%p] Unsupported receive hash information 0x%08x.\n", Adapter, HashParams->HashInformation);
+            return NDIS_STATUS_INVALID_PARAMETER;
+        }
+
+        if(!(HashParams->Flags & NDIS_RECEIVE_HASH_FLAG_HASH_KEY_UNCHANGED)
+            &&
+            (HashParams->HashSecretKeySize == 0
+             || HashParams->HashSecretKeySize > NIC_RSS_MAX_HASH_KEY_SIZE
+             || !RSSValidBufferRange(ParametersLength, HashParams->HashSecretKeyOffset, HashParams->HashSecretKeySize)))
+        {
+            DEBUGP(MP_ERROR, "[%p] Invalid receive hash key. Size: %i\n", Adapter, HashParams->HashSecretKeySize);
+            return NDIS_STATUS_INVALID_PARAMETER;
+        }
+    }
+
+    NdisAcquireRWLockWrite(RSSData->RssLock, &LockState, 0);
+
+    if(EnableHash)
+    {
+        if(!(HashParams->Flags & NDIS_RECEIVE_HASH_FLAG_HASH_INFO_UNCHANGED))
+        {
+            RSSData->ReceiveHash.HashInformation = HashParams->HashInformation;
+        }
+
+        if(!(HashParams->Flags & NDIS_RECEIVE_HASH_FLAG_HASH_KEY_UNCHANGED))
+        {
+            NdisMoveMemory(
+                RSSData->ReceiveHash.HashSecretKey,
+                (PUCHAR)HashParams + HashParams->HashSecretKeyOffset,
+                HashParams->HashSecretKeySize);
+            RSSData->ReceiveHash.HashSecretKeySize = HashParams->HashSecretKeySize;
+        }
+
+        RSS_SET_FLAG(Adapter, fMPRSSD_HASH_ENABLED);
+    }
+    else
+    {
+        RSS_CLEAR_FLAG(Adapter, fMPRSSD_HASH_ENABLED);
+    }
+
+    NdisReleaseRWLock(RSSData->RssLock, &LockState);
+
+    DEBUGP(MP_TRACE, "[%p] <--- SetReceiveHash\n", Adapter);
+
+    return NDIS_STATUS_SUCCESS;
+}
+
+NDIS_STATUS
+QueryReceiveHash(
+    _In_ struct _MP_ADAPTER *Adapter,
+    _Out_writes_bytes_to_opt_(BufferLength, *BytesNeeded) PVOID Buffer,
+    ULONG BufferLength,
+    _Out_ PULONG BytesNeeded)
+/*++
+Routine Description:
+
+    This routine returns the current receive hash parameters for OID_GEN_RECEIVE_HASH, followed by the
+    hash key. The result is only written if it fits in the buffer.
+
+    Runs at IRQL = PASSIVE_LEVEL.
+
+Arguments:
+
+    Adapter             - Pointer to our adapter
+    Buffer              - OID buffer
+    BufferLength        - Size of the OID buffer
+    BytesNeeded         - Set to the size of the result
+
+Return Value:
+
+    NDIS_STATUS
+
+--*/
+{
+    PMP_ADAPTER_RSS_DATA RSSData = &Adapter->RSSData;
+    PNDIS_RECEIVE_HASH_PARAMETERS HashParams = (PNDIS_RECEIVE_HASH_PARAMETERS)Buffer;
+    LOCK_STATE_EX LockState;
+
+    *BytesNeeded = 0;
+
+    if(!RSS_SUPPORTED(Adapter))
+    {
+        return NDIS_STATUS_NOT_SUPPORTED;
+    }
+
+    NdisAcquireRWLockRead(RSSData->RssLock, &LockState, 0);
+
+    *BytesNeeded = NDIS_SIZEOF_RECEIVE_HASH_PARAMETERS_REVISION_1 + RSSData->ReceiveHash.HashSecretKeySize;
+
+    if(HashParams && BufferLength >= *BytesNeeded)
+    {
+        NdisZeroMemory(HashParams, NDIS_SIZEOF_RECEIVE_HASH_PARAMETERS_REVISION_1);
+        HashParams->Header.Type = NDIS_OBJECT_TYPE_DEFAULT;
+        HashParams->Header.Revision = NDIS_RECEIVE_HASH_PARAMETERS_REVISION_1;
+        HashParams->Header.Size = NDIS_SIZEOF_RECEIVE_HASH_PARAMETERS_REVISION_1;
+
+        HashParams->Flags = (RSSData->Flags & fMPRSSD_HASH_ENABLED) ? NDIS_RECEIVE_HASH_FLAG_ENABLE_HASH : 0;
+        HashParams->HashInformation = RSSData->ReceiveHash.HashInformation;
+
+        HashParams->HashSecretKeySize = RSSData->ReceiveHash.HashSecretKeySize;
+        HashParams->HashSecretKeyOffset = NDIS_SIZEOF_RECEIVE_HASH_PARAMETERS_REVISION_1;
+        NdisMoveMemory((PUCHAR)HashParams + HashParams->HashSecretKeyOffset, RSSData->ReceiveHash.HashSecretKey, RSSData->ReceiveHash.HashSecretKeySize);
+    }
+
+    NdisReleaseRWLock(RSSData->RssLock, &LockState);
+
+    return NDIS_STATUS_SUCCESS;
+}
+
+VOID
+AddPendingRcbToRssQueue(
+    _In_ struct _MP_ADAPTER *Adapter,
+    _In_ struct _FRAME *Frame,
+    _In_ struct _RCB *Rcb)
+/*++
+Routine Description:
+
+    This routine hashes a received frame, records the hash in the RCB's NBL, and queues the RCB on the
+    receive block of the RSS queue the indirection table selects. Frames that are not hashed, and all
+    frames when only receive hashing is enabled, go to the default queue. The queue's DPC is scheduled
+    before the RSS lock is dropped, so an indirection table update can't strand the receive on a DPC
+    that no longer consumes the queue.
+
+    Runs at IRQL = DISPATCH_LEVEL.
+
+Arguments:
+
+    Adapter             - Pointer to our adapter
+    Frame               - The received frame
+    Rcb                 - The RCB holding the frame
+
+Return Value:
+
+    None
+
+--*/
+{
+    PMP_ADAPTER_RSS_DATA RSSData = &Adapter->RSSData;
+    PMP_ADAPTER_HASH_CONFIG HashConfig = NULL;
+    ULONG HashValue = 0, HashType = 0;
+    USHORT QueueId = 0;
+    LOCK_STATE_EX LockState;
+
+    NdisAcquireRWLockRead(RSSData->RssLock, &LockState, NDIS_RWL_AT_DISPATCH_LEVEL);
+
+    if(RSS_ENABLED(Adapter))
+    {
+        HashConfig = &RSSData->RssHash;
+    }
+    else if(RSSData->Flags & fMPRSSD_HASH_ENABLED)
+    {
+        HashConfig = &RSSData->ReceiveHash;
+    }
+
+    if(HashConfig)
+    {
+        HashType = RSSHashFrame(HashConfig, Frame, &HashValue);
+    }
+
+    if(HashType)
+    {
+        NET_BUFFER_LIST_SET_HASH_VALUE(Rcb->Nbl, HashValue);
+        NET_BUFFER_LIST_SET_HASH_TYPE(Rcb->Nbl, HashType);
+        NET_BUFFER_LIST_SET_HASH_FUNCTION(Rcb->Nbl, NdisHashFunctionToeplitz);
+
+        if(RSS_ENABLED(Adapter) && RSSData->IndirectionTableEntries)
+        {
+            QueueId = RSSData->IndirectionQueue[HashValue & (RSSData->IndirectionTableEntries - 1)];
+        }
+    }
+
+    NdisInterlockedInsertTailList(
+        &Adapter->ReceiveBlock[QueueId].ReceiveList,
+        &Rcb->RcbLink,
+        &Adapter->ReceiveBlock[QueueId].ReceiveListLock);
+
+    RXScheduleReceiveDpc(Adapter, RSSData->QueueDpc[QueueId]);
+
+    NdisReleaseRWLock(RSSData->RssLock, &LockState);
+}
@@ -0,0 +1,171 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+   Rss.h
+
+Abstract:
+
+   This module declares the RSS related data types, flags, macros, and functions.
+
+Revision History:
+
+Notes:
+
+--*/
+
+
+struct _FRAME;
+struct _RCB;
+
+#if (NDIS_SUPPORT_NDIS620)
+
+//
+// Flags tracking global RSS state
+//
+//
+// RSS is enabled in the registry (and VMQ is not), so it is advertised to NDIS.
+//
+#define fMPRSSD_RSS_SUPPORTED           0x0001
+//
+// RSS was enabled through OID_GEN_RECEIVE_SCALE_PARAMETERS. Receives are hashed and spread
+// across the RSS queues.
+//
+#define fMPRSSD_RSS_ENABLED             0x0002
+//
+// Receive hashing was enabled through OID_GEN_RECEIVE_HASH. Receives are hashed, but all of
+// them are indicated on the default queue.
+//
+#define fMPRSSD_HASH_ENABLED            0x0004
+
+#define RSS_SET_FLAG(_Adapter, _Flag) \
+    ((_Adapter)->RSSData.Flags |= (_Flag))
+
+#define RSS_CLEAR_FLAG(_Adapter, _Flag) \
+    ((_Adapter)->RSSData.Flags &= ~(_Flag))
+
+#define RSS_SUPPORTED(_Adapter) \
+        ((_Adapter)->RSSData.Flags & fMPRSSD_RSS_SUPPORTED)
+#define RSS_ENABLED(_Adapter) \
+        ((_Adapter)->RSSData.Flags & fMPRSSD_RSS_ENABLED)
+#define RSS_HASH_ENABLED(_Adapter) \
+        ((_Adapter)->RSSData.Flags & (fMPRSSD_RSS_ENABLED | fMPRSSD_HASH_ENABLED))
+
+//
+// A hash configuration (hash function and types, and the secret key) as programmed by either
+// OID_GEN_RECEIVE_SCALE_PARAMETERS or OID_GEN_RECEIVE_HASH.
+//
+typedef struct _MP_ADAPTER_HASH_CONFIG
+{
+    ULONG HashInformation;
+    USHORT HashSecretKeySize;
+    UCHAR HashSecretKey[NIC_RSS_MAX_HASH_KEY_SIZE];
+} MP_ADAPTER_HASH_CONFIG, *PMP_ADAPTER_HASH_CONFIG;
+
+//
+// The MP_ADAPTER_RSS_DATA structure is used to track the RSS configuration for an adapter
+//
+typedef struct _MP_ADAPTER_RSS_DATA
+{
+    //
+    // Tracks global RSS state (fMPRSSD_* flags)
+    //
+    ULONG Flags;
+    //
+    // Protects the hash configurations, the indirection table and the queue DPCs. Receives
+    // take it for read; the RSS OIDs take it for write.
+    //
+    PNDIS_RW_LOCK_EX RssLock;
+
+    MP_ADAPTER_HASH_CONFIG RssHash;
+    MP_ADAPTER_HASH_CONFIG ReceiveHash;
+
+    //
+    // Indirection table as set by NDIS (returned on queries), and the RSS queue that each of
+    // its entries maps to. The number of entries is always a power of 2.
+    //
+    USHORT BaseCpuNumber;
+    USHORT IndirectionTableEntries;
+    PROCESSOR_NUMBER IndirectionTable[NIC_RSS_MAX_INDIRECTION_TABLE_ENTRIES];
+    UCHAR IndirectionQueue[NIC_RSS_MAX_INDIRECTION_TABLE_ENTRIES];
+
+    //
+    // DPC that consumes the receive block of each RSS queue. QueueDpc[0] is always the
+    // adapter's default receive DPC.
+    //
+    struct _MP_ADAPTER_RECEIVE_DPC *QueueDpc[NIC_SUPPORTED_NUM_RSS_QUEUES];
+} MP_ADAPTER_RSS_DATA, *PMP_ADAPTER_RSS_DATA;
+
+NDIS_STATUS
+AllocateRSSData(
+    _Inout_ struct _MP_ADAPTER *Adapter);
+
+VOID
+FreeRSSData(
+    _Inout_ struct _MP_ADAPTER *Adapter);
+
+NDIS_STATUS
+ReadRSSConfig(
+    _In_ NDIS_HANDLE ConfigurationHandle,
+    _Inout_ struct _MP_ADAPTER *Adapter);
+
+NDIS_STATUS
+AllocateRSSQueues(
+    _Inout_ struct _MP_ADAPTER *Adapter);
+
+NDIS_STATUS
+SetRSSParameters(
+    _Inout_ struct _MP_ADAPTER *Adapter,
+    _In_reads_bytes_(ParametersLength) PNDIS_RECEIVE_SCALE_PARAMETERS RssParams,
+    ULONG ParametersLength);
+
+NDIS_STATUS
+QueryRSSParameters(
+    _In_ struct _MP_ADAPTER *Adapter,
+    _Out_writes_bytes_to_opt_(BufferLength, *BytesNeeded) PVOID Buffer,
+    ULONG BufferLength,
+    _Out_ PULONG BytesNeeded);
+
+NDIS_STATUS
+SetReceiveHash(
+    _Inout_ struct _MP_ADAPTER *Adapter,
+    _In_reads_bytes_(ParametersLength) PNDIS_RECEIVE_HASH_PARAMETERS HashParams,
+    ULONG ParametersLength);
+
+NDIS_STATUS
+QueryReceiveHash(
+    _In_ struct _MP_ADAPTER *Adapter,
+    _Out_writes_bytes_to_opt_(BufferLength, *BytesNeeded) PVOID Buffer,
+    ULONG BufferLength,
+    _Out_ PULONG BytesNeeded);
+
+VOID
+AddPendingRcbToRssQueue(
+    _In_ struct _MP_ADAPTER *Adapter,
+    _In_ struct _FRAME *Frame,
+    _In_ struct _RCB *Rcb);
+
+#else
+
+//
+// NDIS60 miniports define placeholder macros for the RSS functions which cause
+// the code to always proceed as if RSS were not supported by the adapter.
+//
+
+#define RSS_SUPPORTED(_Adapter) FALSE
+#define RSS_ENABLED(_Adapter) FALSE
+#define RSS_HASH_ENABLED(_Adapter) FALSE
+#define AllocateRSSData(Adapter) NDIS_STATUS_SUCCESS
+#define FreeRSSData(Adapter)
+#define ReadRSSConfig(ConfigurationHandle, Adapter) NDIS_STATUS_SUCCESS
+#define AllocateRSSQueues(Adapter) NDIS_STATUS_SUCCESS
+#define AddPendingRcbToRssQueue(Adapter, Frame, Rcb)
+
+#endif
@@ -36,18 +36,135 @@ Notes:
 #include "tcbrcb.tmh"
 
 
+static
+ULONG
+NICGetCurrentRcbStackId(VOID)
+/*++
+
+Routine Description:
+
+    Returns the free RCB stack used by the current processor.
+
+    Runs at IRQL <= DISPATCH_LEVEL
+
+--*/
+{
+#if (NDIS_SUPPORT_NDIS620)
+    return KeGetCurrentProcessorNumberEx(NULL) % NIC_SUPPORTED_NUM_QUEUES;
+#else
+    return KeGetCurrentProcessorNumber() % NIC_SUPPORTED_NUM_QUEUES;
+#endif
+}
+
+
+_Must_inspect_result_
+_Success_(return != NULL)
+PTCB
+GetTCB(
+    _In_  PMP_ADAPTER  Adapter,
+    _In_  ULONG        TxQueueId)
+/*++
+
+Routine Description:
+
+    This routine gets an unused TCB for a transmit queue. The TCB comes from
+    the queue's own stack if possible, then from the shared pool, and finally
+    from another queue's stack.
+
+    Runs at IRQL <= DISPATCH_LEVEL
+
+Arguments:
+
+    Adapter                     The sending adapter
+    TxQueueId                   The transmit queue that will send with the TCB
+
+Return Value:
+
+    NULL if all the TCBs are in use.
+    Else, a pointer to an unused TCB.
+
+--*/
+{
+    PMP_ADAPTER_TX_QUEUE TxQueue = &Adapter->TxQueue[TxQueueId];
+    PSLIST_ENTRY pStackEntry;
+    PLIST_ENTRY pEntry;
+    PTCB Tcb = NULL;
+    ULONG index;
+
+    pStackEntry = InterlockedPopEntrySList(&TxQueue->FreeTcbStack);
+    if (pStackEntry)
+    {
+        InterlockedDecrement(&TxQueue->FreeTcbCount);
+        Tcb = CONTAINING_RECORD(pStackEntry, TCB, FreeLink);
+    }
+    else if (NULL != (pEntry = NdisInterlockedRemoveHeadList(
+                    &Adapter->FreeTcbList,
+                    &Adapter->FreeTcbListLock)))
+    {
+        Tcb = CONTAINING_RECORD(pEntry, TCB, TcbLink);
+    }
+    else
+    {
+        for (index = 1; index < NIC_SUPPORTED_NUM_TX_QUEUES && !Tcb; index++)
+        {
+            PMP_ADAPTER_TX_QUEUE OtherQueue = &Adapter->TxQueue[(TxQueueId + index) % NIC_SUPPORTED_NUM_TX_QUEUES];
+
+            pStackEntry = InterlockedPopEntrySList(&OtherQueue->FreeTcbStack);
+            if (pStackEntry)
+            {
+                InterlockedDecrement(&OtherQueue->FreeTcbCount);
+                InterlockedIncrement(&TxQueue->TcbSteals);
+                Tcb = CONTAINING_RECORD(pStackEntry, TCB, FreeLink);
+            }
+        }
+    }
+
+    if (Tcb)
+    {
+        Tcb->NetBuffer = NULL;
+        Tcb->TxQueueId = TxQueueId;
+    }
+
+    return Tcb;
+}
+
+
 VOID
 ReturnTCB(
     _In_  PMP_ADAPTER  Adapter,
     _In_  PTCB         Tcb)
+/*++
+
+Routine Description:
+
+    This routine releases the TCB's NET_BUFFER (if any) and frees the TCB back
+    to the stack of its transmit queue, or to the shared pool if that stack
+    is full.
+
+    Runs at IRQL = DISPATCH_LEVEL
+
+--*/
 {
-    TXNblRelease(Adapter, NBL_FROM_SEND_NB(Tcb->NetBuffer), TRUE);
-    Tcb->NetBuffer = NULL;
+    PMP_ADAPTER_TX_QUEUE TxQueue = &Adapter->TxQueue[Tcb->TxQueueId];
+
+    if (Tcb->NetBuffer)
+    {
+        TXNblRelease(Adapter, NBL_FROM_SEND_NB(Tcb->NetBuffer), TRUE);
+        Tcb->NetBuffer = NULL;
+    }
 
-    NdisInterlockedInsertTailList(
-            &Adapter->FreeTcbList,
-            &Tcb->TcbLink,
-            &Adapter->FreeTcbListLock);
+    if (TxQueue->FreeTcbCount < NIC_MAX_FREE_TCBS_PER_QUEUE)
+    {
+        InterlockedIncrement(&TxQueue->FreeTcbCount);
+        InterlockedPushEntrySList(&TxQueue->FreeTcbStack, &Tcb->FreeLink);
+    }
+    else
+    {
+        NdisInterlockedInsertTailList(
+                &Adapter->FreeTcbList,
+                &Tcb->TcbLink,
+                &Adapter->FreeTcbListLock);
+    }
 }
 
 
@@ -95,14 +212,48 @@ Return Value:
     else
     {
         //
-        // Retrieve the RCB from the global RCB pool
+        // Retrieve the RCB from this processor's stack, then from the global
+        // RCB pool, and finally from another processor's stack
         //
-        PLIST_ENTRY pEntry = NdisInterlockedRemoveHeadList(
-                &Adapter->FreeRcbList,
-                &Adapter->FreeRcbListLock);
-        if (pEntry)
+        ULONG StackId = NICGetCurrentRcbStackId();
+        PMP_ADAPTER_RCB_STACK RcbStack = &Adapter->RcbStack[StackId];
+        PSLIST_ENTRY pStackEntry;
+        PLIST_ENTRY pEntry;
+
+        pStackEntry = InterlockedPopEntrySList(&RcbStack->FreeRcbStack);
+        if (pStackEntry)
+        {
+            InterlockedDecrement(&RcbStack->FreeRcbCount);
+            Rcb = CONTAINING_RECORD(pStackEntry, RCB, FreeLink);
+        }
+        else if (NULL != (pEntry = NdisInterlockedRemoveHeadList(
+                        &Adapter->FreeRcbList,
+                        &Adapter->FreeRcbListLock)))
         {
             Rcb = CONTAINING_RECORD(pEntry, RCB, RcbLink);
+        }
+        else
+        {
+            ULONG index;
+
+            for (index = 1; index < NIC_SUPPORTED_NUM_QUEUES && !Rcb; index++)
+            {
+                PMP_ADAPTER_RCB_STACK OtherStack = &Adapter->RcbStack[(StackId + index) % NIC_SUPPORTED_NUM_QUEUES];
+
+                pStackEntry = InterlockedPopEntrySList(&OtherStack->FreeRcbStack);
+                if (pStackEntry)
+                {
+                    InterlockedDecrement(&OtherStack->FreeRcbCount);
+                    InterlockedIncrement(&RcbStack->RcbSteals);
+                    Rcb = CONTAINING_RECORD(pStackEntry, RCB, FreeLink);
+                }
+            }
+        }
+
+        if (Rcb)
+        {
+            Rcb->StackId = StackId;
+
             //
             // Receiving on the default receive queue, increment its pending count
             //
@@ -200,12 +351,22 @@ Return Value:
     else
     {
         //
-        // Recover RCB to global RCB pool
+        // Recover RCB to the stack it came from, or to the global RCB pool if that stack is full
         //
-        NdisInterlockedInsertTailList(
-                &Adapter->FreeRcbList,
-                &Rcb->RcbLink,
-                &Adapter->FreeRcbListLock);
+        PMP_ADAPTER_RCB_STACK RcbStack = &Adapter->RcbStack[Rcb->StackId];
+
+        if (RcbStack->FreeRcbCount < NIC_MAX_FREE_RCBS_PER_QUEUE)
+        {
+            InterlockedIncrement(&RcbStack->FreeRcbCount);
+            InterlockedPushEntrySList(&RcbStack->FreeRcbStack, &Rcb->FreeLink);
+        }
+        else
+        {
+            NdisInterlockedInsertTailList(
+                    &Adapter->FreeRcbList,
+                    &Rcb->RcbLink,
+                    &Adapter->FreeRcbListLock);
+        }
         Rcb = NULL;
         //
         // We receive on the default receive queue, decrement its pending count
@@ -33,13 +33,21 @@ Abstract:
 
 typedef struct _TCB
 {
+    SLIST_ENTRY             FreeLink;
     LIST_ENTRY              TcbLink;
     PNET_BUFFER             NetBuffer;
     ULONG                   FrameType;
     ULONG                   BytesActuallySent;
+    ULONG                   TxQueueId;
 } TCB, *PTCB;
 
 
+_Must_inspect_result_
+_Success_(return != NULL)
+PTCB
+GetTCB(
+    _In_  PMP_ADAPTER  Adapter,
+    _In_  ULONG        TxQueueId);
 
 VOID
 ReturnTCB(
@@ -54,12 +62,14 @@ ReturnTCB(
 
 typedef struct _RCB
 {
+    SLIST_ENTRY             FreeLink;
     LIST_ENTRY              RcbLink;
     PNET_BUFFER_LIST        Nbl;
     PVOID                   Data;
 #if (NDIS_SUPPORT_NDIS620)    
     PVOID                   LookaheadData;
 #endif
+    ULONG                   StackId;
 } RCB, *PRCB;
 
 _Must_inspect_result_
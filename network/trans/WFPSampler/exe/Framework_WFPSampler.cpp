@@ -66,6 +66,8 @@ typedef enum WFPSAMPLER_FLOW_CONTROL_
    FLOW_CONTROL_NORMAL = 0,
    FLOW_CONTROL_HELP   = 1,
    FLOW_CONTROL_CLEAN  = 2,
+   FLOW_CONTROL_BULK   = 3,
+   FLOW_CONTROL_STATS  = 4,
 }WFPSAMPLER_FLOW_CONTROL;
 
 ///
@@ -75,6 +77,9 @@ typedef enum WFPSAMPLER_FLOW_CONTROL_
  
    Purpose:  Parse the command line parameters for any flow control commands such as:           <br>
                 help (-?) (?) (-help)                                                           <br>
+                clean (-clean)                                                                  <br>
+                bulk load (-bulk)                                                               <br>
+                callout statistics (-stats)                                                     <br>
                                                                                                 <br>
    Notes:                                                                                       <br>
                                                                                                 <br>
@@ -116,6 +121,24 @@ WFPSAMPLER_FLOW_CONTROL PrvFlowControlGet(_In_reads_(stringCount) PCWSTR* ppCLPS
       {
          flowControl = FLOW_CONTROL_CLEAN;
 
+         break;
+      }
+      else if(HlprStringsAreEqual(ppCLPStrings[stringIndex],
+                                  L"-bulk") ||
+              HlprStringsAreEqual(ppCLPStrings[stringIndex],
+                                  L"/bulk"))
+      {
+         flowControl = FLOW_CONTROL_BULK;
+
+         break;
+      }
+      else if(HlprStringsAreEqual(ppCLPStrings[stringIndex],
+                                  L"-stats") ||
+              HlprStringsAreEqual(ppCLPStrings[stringIndex],
+                                  L"/stats"))
+      {
+         flowControl = FLOW_CONTROL_STATS;
+
          break;
       }
    }
@@ -818,6 +841,8 @@ VOID PrvLogUsage(_In_ UINT32 scenario)
       wprintf(L"\n\t\t        \t    default  \t Removes all of WFPSampler's objects except its Provider and SubLayer. 3rd party policy is preserved. [Optional]");
       wprintf(L"\n\t\t        \t    firewall \t Removes all of WFP's kernel-mode objects except built-in and WFPSampler's Provider and SubLayer. IPsec Policy will be preserved. [Optional]");
       wprintf(L"\n\t\t        \t    all      \t Removes all WFP objects except built-in and WFPSampler's Provider and SubLayer. No policy is preserved. [Optional]");
+      HlprBulkLoadLogHelp();
+      HlprCalloutStatisticsLogHelp();
       wprintf(L"\n\t\t -s     \t Specify one of the following scenarios.");
       wprintf(L"\n\t\t\t\t ADVANCED_PACKET_INJECTION");
 
@@ -893,6 +918,24 @@ int __cdecl wmain(_In_ const int argumentCount,
             flowControl = FLOW_CONTROL_NORMAL;
       }
 
+      /// Rules are written straight to BFE, so neither the service nor RPC is needed
+      if(flowControl == FLOW_CONTROL_BULK)
+      {
+         status = HlprBulkLoadExecute(ppCommandLineParameterStrings,
+                                      stringCount);
+
+         HLPR_BAIL;
+      }
+
+      /// Counters are read straight from the callout driver's control device
+      if(flowControl == FLOW_CONTROL_STATS)
+      {
+         status = HlprCalloutStatisticsExecute(ppCommandLineParameterStrings,
+                                               stringCount);
+
+         HLPR_BAIL;
+      }
+
       if(flowControl == FLOW_CONTROL_NORMAL)
       {
          if(scenario == SCENARIO_UNDEFINED ||
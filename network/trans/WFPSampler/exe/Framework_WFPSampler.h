@@ -21,24 +21,28 @@
 #ifndef FRAMEWORK_WFP_SAMPLER_H
 #define FRAMEWORK_WFP_SAMPLER_H
 
-#include <Windows.h>                     /// Include\UM
-#include <WInternl.h>                    /// Include\UM
-#include <StdLib.h>                      /// Inc\CRT
-#include <FWPSU.h>                       /// Include\UM
-#include <FWPMU.h>                       /// Include\UM
-#include <NTDDNDIS.h>                    /// Include\Shared
-#include <WinSock2.h>                    /// Include\UM
-#include <WS2TCPIP.h>                    /// Include\UM
-#include <MSTCPIP.h>                     /// Include\Shared
-#include <StrSafe.h>                     /// Include\Shared
-#include <IntSafe.h>                     /// Include\Shared
+#include <Windows.h>                           /// Include\UM
+#include <WInternl.h>                          /// Include\UM
+#include <StdLib.h>                            /// Inc\CRT
+#include <FWPSU.h>                             /// Include\UM
+#include <FWPMU.h>                             /// Include\UM
+#include <NTDDNDIS.h>                          /// Include\Shared
+#include <WinSock2.h>                          /// Include\UM
+#include <WS2TCPIP.h>                          /// Include\UM
+#include <MSTCPIP.h>                           /// Include\Shared
+#include <StrSafe.h>                           /// Include\Shared
+#include <IntSafe.h>                           /// Include\Shared
+#include <WinIoCtl.h>                          /// Include\UM
 
-#include "WFPSamplerRPC.h"               /// $(OBJ_PATH)\..\idl\$(O)
-#include "Identifiers.h"                 /// ..\inc
-#include "WFPArrays.h"                   /// ..\inc
-#include "ScenarioData.h"                /// ..\inc
-#include "HelperFunctions_Include.h"     /// ..\lib
-#include "HelperFunctions_CommandLine.h" /// .
-#include "Scenarios_Include.h"           /// .
+#include "WFPSamplerRPC.h"                     /// $(OBJ_PATH)\..\idl\$(O)
+#include "Identifiers.h"                       /// ..\inc
+#include "WFPArrays.h"                         /// ..\inc
+#include "ScenarioData.h"                      /// ..\inc
+#include "CalloutStatistics.h"                 /// ..\inc
+#include "HelperFunctions_Include.h"           /// ..\lib
+#include "HelperFunctions_CommandLine.h"       /// .
+#include "HelperFunctions_BulkLoad.h"          /// .
+#include "HelperFunctions_CalloutStatistics.h" /// .
+#include "Scenarios_Include.h"                 /// .
 
 #endif /// FRAMEWORK_WFP_SAMPLER_H
\ No newline at end of file
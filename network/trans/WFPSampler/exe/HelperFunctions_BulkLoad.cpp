@@ -0,0 +1,1225 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//   Copyright (c) 2014 Microsoft Corporation.  All Rights Reserved.
+//
+//   Module Name:
+//      HelperFunctions_BulkLoad.cpp
+//
+//   Abstract:
+//      This module contains functions which load a file of filter rules into BFE.  Rather than
+//         paying for an implicit transaction per object, the sublayer, callouts and filters are
+//         added in a small number of explicit transactions.
+//
+//   Naming Convention:
+//
+//      <Scope><Module><Object><Action><Modifier>
+//
+//      i.e.
+//
+//       <Scope>
+//          {
+//                                          - Function is likely visible to other modules.
+//            Prv                           - Function is private to this module.
+//          }
+//       <Module>
+//          {
+//            Hlpr                          - Function is from HelperFunctions_* Modules.
+//          }
+//       <Object>
+//          {
+//            BulkLoad                      - Function pertains to loading a rule file.
+//          }
+//       <Action>
+//          {
+//            Execute            - Function carries out the bulk load.
+//            LogHelp            - Function writes usage information to the console.
+//          }
+//       <Modifier>
+//          {
+//
+//          }
+//
+//   Private Functions:
+//      PrvHlprBulkLoadBatchAdvance(),
+//      PrvHlprBulkLoadBatchFinish(),
+//      PrvHlprBulkLoadBatchPrepare(),
+//      PrvHlprBulkLoadCalloutAdd(),
+//      PrvHlprBulkLoadFileRead(),
+//      PrvHlprBulkLoadFilterKeyMake(),
+//      PrvHlprBulkLoadInstalledFiltersMatch(),
+//      PrvHlprBulkLoadPolicyParse(),
+//      PrvHlprBulkLoadPolicyPurge(),
+//      PrvHlprBulkLoadRuleCompare(),
+//      PrvHlprBulkLoadRuleFind(),
+//      PrvHlprBulkLoadRuleParse(),
+//
+//   Public Functions:
+//      HlprBulkLoadExecute(),
+//      HlprBulkLoadLogHelp(),
+//
+//   Author:
+//      Dusty Harper      (DHarper)
+//
+//   Revision History:
+//
+//      [ Month ][Day] [Year] - [Revision]-[ Comments ]
+//      May       01,   2010  -     1.0   -  Creation
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "Framework_WFPSampler.h" /// .
+
+/// Every filter added by the bulk loader carries this name.  It is how a reload tells the filters
+/// it owns apart from the ones added by the scenarios.
+static PCWSTR g_pBulkLoadFilterName = L"WFPSampler's Bulk Load Filter";
+
+typedef struct BULK_LOAD_RULE_
+{
+   PWSTR       pRuleText;   /// normalized rule, also used as the filter's description
+   FWPM_FILTER filter;
+   BOOLEAN     isInstalled; /// BFE already has this filter (or it is a duplicate line)
+}BULK_LOAD_RULE, *PBULK_LOAD_RULE;
+
+typedef struct BULK_LOAD_POLICY_
+{
+   PWSTR           pFileText;
+   BULK_LOAD_RULE* pRules;             /// sorted by filterKey once parsed
+   UINT32          numRules;
+   UINT32          maxRules;
+   UINT32          numDuplicates;
+   FWPM_CALLOUT*   pCallouts;
+   UINT32          numCallouts;
+   GUID*           pStaleFilterKeys;   /// installed bulk load filters no longer in the file
+   UINT32          numStaleFilterKeys;
+   UINT32          maxStaleFilterKeys;
+}BULK_LOAD_POLICY, *PBULK_LOAD_POLICY;
+
+typedef struct BULK_LOAD_BATCH_
+{
+   HANDLE  engineHandle;
+   UINT32  batchSize;
+   UINT32  numOperations;   /// operations issued in the open transaction
+   UINT32  numTransactions;
+   BOOLEAN inTransaction;
+}BULK_LOAD_BATCH, *PBULK_LOAD_BATCH;
+
+/**
+ @private_function="PrvHlprBulkLoadBatchPrepare"
+
+   Purpose:  Make sure a transaction is open before the next operation is issued.               <br>
+                                                                                                <br>
+   Notes:                                                                                       <br>
+                                                                                                <br>
+   MSDN_Ref: HTTP://MSDN.Microsoft.com/En-US/Library/Windows/Desktop/AA364245.aspx              <br>
+*/
+_Success_(return == NO_ERROR)
+UINT32 PrvHlprBulkLoadBatchPrepare(_Inout_ BULK_LOAD_BATCH* pBatch)
+{
+   ASSERT(pBatch);
+
+   UINT32 status = NO_ERROR;
+
+   if(!(pBatch->inTransaction))
+   {
+      status = HlprFwpmTransactionBegin(pBatch->engineHandle);
+      if(status == NO_ERROR)
+      {
+         pBatch->inTransaction = TRUE;
+         pBatch->numOperations = 0;
+
+         pBatch->numTransactions++;
+      }
+   }
+
+   return status;
+}
+
+/**
+ @private_function="PrvHlprBulkLoadBatchAdvance"
+
+   Purpose:  Account for an operation issued in the open transaction, and commit the
+             transaction once it holds batchSize operations.                                    <br>
+                                                                                                <br>
+   Notes:                                                                                       <br>
+                                                                                                <br>
+   MSDN_Ref: HTTP://MSDN.Microsoft.com/En-US/Library/Windows/Desktop/AA364246.aspx              <br>
+*/
+_Success_(return == NO_ERROR)
+UINT32 PrvHlprBulkLoadBatchAdvance(_Inout_ BULK_LOAD_BATCH* pBatch)
+{
+   ASSERT(pBatch);
+   ASSERT(pBatch->inTransaction);
+
+   UINT32 status = NO_ERROR;
+
+   pBatch->numOperations++;
+
+   if(pBatch->numOperations >= pBatch->batchSize)
+   {
+      /// BFE discards the transaction if the commit fails, so it is closed either way
+      pBatch->inTransaction = FALSE;
+
+      status = HlprFwpmTransactionCommit(pBatch->engineHandle);
+   }
+
+   return status;
+}
+
+/**
+ @private_function="PrvHlprBulkLoadBatchFinish"
+
+   Purpose:  Commit the open transaction if everything up to this point succeeded, otherwise
+             abort it.                                                                          <br>
+                                                                                                <br>
+   Notes:    Transactions that were already committed stay committed.  Since a load only adds
+             what BFE is missing, rerunning the same file picks up where a failed load stopped. <br>
+                                                                                                <br>
+   MSDN_Ref: HTTP://MSDN.Microsoft.com/En-US/Library/Windows/Desktop/AA364243.aspx              <br>
+*/
+UINT32 PrvHlprBulkLoadBatchFinish(_Inout_ BULK_LOAD_BATCH* pBatch,
+                                  _In_ UINT32 status)
+{
+   ASSERT(pBatch);
+
+   if(pBatch->inTransaction)
+   {
+      pBatch->inTransaction = FALSE;
+
+      if(status == NO_ERROR)
+         status = HlprFwpmTransactionCommit(pBatch->engineHandle);
+      else
+         HlprFwpmTransactionAbort(pBatch->engineHandle);
+   }
+
+   return status;
+}
+
+/**
+ @private_function="PrvHlprBulkLoadRuleCompare"
+
+   Purpose:  qsort comparator which orders rules by their filterKey.                            <br>
+                                                                                                <br>
+   Notes:                                                                                       <br>
+                                                                                                <br>
+   MSDN_Ref:                                                                                    <br>
+*/
+int __cdecl PrvHlprBulkLoadRuleCompare(_In_ const VOID* pRuleAlpha,
+                                       _In_ const VOID* pRuleOmega)
+{
+   ASSERT(pRuleAlpha);
+   ASSERT(pRuleOmega);
+
+   return memcmp(&(((const BULK_LOAD_RULE*)pRuleAlpha)->filter.filterKey),
+                 &(((const BULK_LOAD_RULE*)pRuleOmega)->filter.filterKey),
+                 sizeof(GUID));
+}
+
+/**
+ @private_function="PrvHlprBulkLoadRuleFind"
+
+   Purpose:  Binary search the sorted rules for the first one with the provided filterKey.      <br>
+                                                                                                <br>
+   Notes:    The first rule is returned so duplicates, which are flagged after sorting, are
+             never mistaken for the original.                                                   <br>
+                                                                                                <br>
+   MSDN_Ref:                                                                                    <br>
+*/
+_Success_(return != 0)
+BULK_LOAD_RULE* PrvHlprBulkLoadRuleFind(_In_ const BULK_LOAD_POLICY* pPolicy,
+                                        _In_ const GUID* pFilterKey)
+{
+   ASSERT(pPolicy);
+   ASSERT(pFilterKey);
+
+   UINT32 lowIndex  = 0;
+   UINT32 highIndex = pPolicy->numRules;
+
+   while(lowIndex < highIndex)
+   {
+      UINT32 middleIndex = lowIndex + ((highIndex - lowIndex) / 2);
+
+      if(memcmp(&(pPolicy->pRules[middleIndex].filter.filterKey),
+                pFilterKey,
+                sizeof(GUID)) < 0)
+         lowIndex = middleIndex + 1;
+      else
+         highIndex = middleIndex;
+   }
+
+   if(lowIndex < pPolicy->numRules &&
+      HlprGUIDsAreEqual(&(pPolicy->pRules[lowIndex].filter.filterKey),
+                        pFilterKey))
+      return &(pPolicy->pRules[lowIndex]);
+
+   return 0;
+}
+
+/**
+ @private_function="PrvHlprBulkLoadFilterKeyMake"
+
+   Purpose:  Derive the filterKey from the normalized rule text.                                <br>
+                                                                                                <br>
+   Notes:    The key is two 64-bit FNV-1a hashes of the case folded text, so the same rule maps
+             to the same filter on every load, and a rule that changed maps to a new filter.    <br>
+             This is what allows a reload to diff the file against BFE by key alone.            <br>
+                                                                                                <br>
+   MSDN_Ref:                                                                                    <br>
+*/
+VOID PrvHlprBulkLoadFilterKeyMake(_In_ PCWSTR pRuleText,
+                                  _Out_ GUID* pFilterKey)
+{
+   ASSERT(pRuleText);
+   ASSERT(pFilterKey);
+
+   UINT64 hashAlpha = 0xCBF29CE484222325;   /// FNV-1a offset basis
+   UINT64 hashOmega = 0x84222325CBF29CE4;
+
+   for(PCWSTR pCharacter = pRuleText;
+       *pCharacter;
+       pCharacter++)
+   {
+      UINT64 character = towlower(*pCharacter);
+
+      hashAlpha = (hashAlpha ^ character) * 0x00000100000001B3;   /// FNV-1a prime
+
+      hashOmega  = (hashOmega ^ character) * 0x00000100000001B3;
+      hashOmega ^= hashOmega >> 29;
+   }
+
+   RtlCopyMemory(pFilterKey,
+                 &hashAlpha,
+                 sizeof(UINT64));
+
+   RtlCopyMemory(&(pFilterKey->Data4[0]),
+                 &hashOmega,
+                 sizeof(UINT64));
+
+   /// Mark it as a name based (version 5, RFC 4122 variant) GUID
+   pFilterKey->Data3    = (pFilterKey->Data3 & 0x0FFF) | 0x5000;
+   pFilterKey->Data4[0] = (pFilterKey->Data4[0] & 0x3F) | 0x80;
+
+   return;
+}
+
+/**
+ @private_function="PrvHlprBulkLoadFileRead"
+
+   Purpose:  Read the rule file into a NULL terminated wide string.                             <br>
+                                                                                                <br>
+   Notes:    Files starting with a UTF-16LE byte order mark are taken as is, everything else is
+             treated as UTF-8 (which covers plain ASCII).                                       <br>
+                                                                                                <br>
+   MSDN_Ref: HTTP://MSDN.Microsoft.com/En-US/Library/Windows/Desktop/AA363858.aspx              <br>
+             HTTP://MSDN.Microsoft.com/En-US/Library/Windows/Desktop/AA365467.aspx              <br>
+             HTTP://MSDN.Microsoft.com/En-US/Library/Windows/Desktop/DD319072.aspx              <br>
+*/
+_At_(*ppFileText, _Pre_ _Null_)
+_When_(return != NO_ERROR, _At_(*ppFileText, _Post_ _Null_))
+_When_(return == NO_ERROR, _At_(*ppFileText, _Post_ _Notnull_))
+_Success_(return == NO_ERROR)
+UINT32 PrvHlprBulkLoadFileRead(_In_ PCWSTR pFileName,
+                               _Outptr_ PWSTR* ppFileText)
+{
+   ASSERT(pFileName);
+   ASSERT(ppFileText);
+
+   UINT32        status     = NO_ERROR;
+   HANDLE        fileHandle = INVALID_HANDLE_VALUE;
+   LARGE_INTEGER fileSize   = {0};
+   BYTE*         pBuffer    = 0;
+   DWORD         bufferSize = 0;
+   DWORD         bytesRead  = 0;
+   UINT32        numChars   = 0;
+   UINT32        numWChars  = 0;
+
+   fileHandle = CreateFile(pFileName,
+                           GENERIC_READ,
+                           FILE_SHARE_READ,
+                           0,
+                           OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL,
+                           0);
+   if(fileHandle == INVALID_HANDLE_VALUE)
+   {
+      status = GetLastError();
+
+      HlprLogError(L"PrvHlprBulkLoadFileRead : CreateFile() [status: %#x][file: %s]",
+                   status,
+                   pFileName);
+
+      HLPR_BAIL;
+   }
+
+   if(GetFileSizeEx(fileHandle,
+                    &fileSize) == 0)
+   {
+      status = GetLastError();
+
+      HlprLogError(L"PrvHlprBulkLoadFileRead : GetFileSizeEx() [status: %#x]",
+                   status);
+
+      HLPR_BAIL;
+   }
+
+   if(fileSize.QuadPart == 0 ||
+      fileSize.QuadPart > MAXLONG)
+   {
+      status = ERROR_INVALID_DATA;
+
+      HlprLogError(L"PrvHlprBulkLoadFileRead : Unsupported File Size [status: %#x][size: %I64d]",
+                   status,
+                   fileSize.QuadPart);
+
+      HLPR_BAIL;
+   }
+
+   bufferSize = (DWORD)fileSize.QuadPart;
+
+   HLPR_NEW_ARRAY(pBuffer,
+                  BYTE,
+                  bufferSize);
+   HLPR_BAIL_ON_ALLOC_FAILURE(pBuffer,
+                              status);
+
+   if(ReadFile(fileHandle,
+               pBuffer,
+               bufferSize,
+               &bytesRead,
+               0) == 0)
+   {
+      status = GetLastError();
+
+      HlprLogError(L"PrvHlprBulkLoadFileRead : ReadFile() [status: %#x]",
+                   status);
+
+      HLPR_BAIL;
+   }
+
+   if(bytesRead >= 2 &&
+      pBuffer[0] == 0xFF &&
+      pBuffer[1] == 0xFE)
+   {
+      numChars  = (bytesRead - 2) / sizeof(WCHAR);
+      numWChars = numChars + 1;
+
+      HLPR_NEW_ARRAY(*ppFileText,
+                     WCHAR,
+                     numWChars);
+      HLPR_BAIL_ON_ALLOC_FAILURE(*ppFileText,
+                                 status);
+
+      RtlCopyMemory(*ppFileText,
+                    &(pBuffer[2]),
+                    numChars * sizeof(WCHAR));
+   }
+   else
+   {
+      UINT32 offset = 0;
+
+      if(bytesRead >= 3 &&
+         pBuffer[0] == 0xEF &&
+         pBuffer[1] == 0xBB &&
+         pBuffer[2] == 0xBF)
+         offset = 3;
+
+      numChars = MultiByteToWideChar(CP_UTF8,
+                                     0,
+                                     (LPCSTR)&(pBuffer[offset]),
+                                     bytesRead - offset,
+                                     0,
+                                     0);
+      if(numChars == 0 &&
+         bytesRead > offset)
+      {
+         status = GetLastError();
+
+         HlprLogError(L"PrvHlprBulkLoadFileRead : MultiByteToWideChar() [status: %#x]",
+                      status);
+
+         HLPR_BAIL;
+      }
+
+      numWChars = numChars + 1;
+
+      HLPR_NEW_ARRAY(*ppFileText,
+                     WCHAR,
+                     numWChars);
+      HLPR_BAIL_ON_ALLOC_FAILURE(*ppFileText,
+                                 status);
+
+      MultiByteToWideChar(CP_UTF8,
+                          0,
+                          (LPCSTR)&(pBuffer[offset]),
+                          bytesRead - offset,
+                          *ppFileText,
+                          numChars);
+   }
+
+   HLPR_BAIL_LABEL:
+
+   if(fileHandle != INVALID_HANDLE_VALUE)
+      CloseHandle(fileHandle);
+
+   HLPR_DELETE_ARRAY(pBuffer);
+
+   if(status != NO_ERROR)
+   {
+      HLPR_DELETE_ARRAY(*ppFileText);
+   }
+
+   return status;
+}
+
+/**
+ @private_function="PrvHlprBulkLoadCalloutAdd"
+
+   Purpose:  Point the filter at the WFPSAMPLER_CALLOUT_BASIC_ACTION_* callout for its action and
+             layer, and record the callout so it is added ahead of the filters.                 <br>
+                                                                                                <br>
+   Notes:    Mirrors the callout and action selection of the service's BASIC_ACTION scenarios.
+             Each callout is recorded once no matter how many rules reference it.               <br>
+                                                                                                <br>
+   MSDN_Ref:                                                                                    <br>
+*/
+VOID PrvHlprBulkLoadCalloutAdd(_Inout_ BULK_LOAD_POLICY* pPolicy,
+                               _Inout_ FWPM_FILTER* pFilter,
+                               _In_ FWP_ACTION_TYPE actionType)
+{
+   ASSERT(pPolicy);
+   ASSERT(pFilter);
+
+   FWP_ACTION_TYPE newActionType = FWP_ACTION_CALLOUT_TERMINATING;
+   GUID            calloutKey    = WFPSAMPLER_CALLOUT_BASIC_ACTION_BLOCK;
+   PCWSTR          pName         = L"WFPSampler's Basic Block Callout";
+   PCWSTR          pDescription  = L"Causes callout invocation which returns FWP_ACTION_BLOCK";
+   UINT32          flags         = 0;
+   FWPM_CALLOUT*   pCallout      = 0;
+
+   if(actionType == FWP_ACTION_CONTINUE)
+   {
+      calloutKey   = WFPSAMPLER_CALLOUT_BASIC_ACTION_CONTINUE;
+      pName        = L"WFPSampler's Basic Continue Callout";
+      pDescription = L"Causes callout invocation which returns FWP_ACTION_CONTINUE";
+
+      newActionType = FWP_ACTION_CALLOUT_UNKNOWN;
+   }
+   else if(actionType == FWP_ACTION_PERMIT)
+   {
+      calloutKey   = WFPSAMPLER_CALLOUT_BASIC_ACTION_PERMIT;
+      pName        = L"WFPSampler's Basic Permit Callout";
+      pDescription = L"Causes callout invocation which returns FWP_ACTION_PERMIT";
+   }
+
+   if(newActionType == FWP_ACTION_CALLOUT_TERMINATING)
+      pFilter->flags |= FWPM_FILTER_FLAG_CLEAR_ACTION_RIGHT;
+
+   calloutKey.Data4[7] = HlprFwpmLayerGetIDByKey(&(pFilter->layerKey));                        /// Uniquely identifies the callout used
+
+   if(pFilter->flags & FWPM_FILTER_FLAG_BOOTTIME ||
+      pFilter->flags & FWPM_FILTER_FLAG_PERSISTENT)
+      flags = FWPM_CALLOUT_FLAG_PERSISTENT;
+
+   pFilter->action.type       = newActionType;
+   pFilter->action.calloutKey = calloutKey;
+
+   for(UINT32 calloutIndex = 0;
+       calloutIndex < pPolicy->numCallouts;
+       calloutIndex++)
+   {
+      if(HlprGUIDsAreEqual(&(pPolicy->pCallouts[calloutIndex].calloutKey),
+                           &calloutKey))
+      {
+         /// One persistent filter is enough to make the shared callout persistent
+         pPolicy->pCallouts[calloutIndex].flags |= flags;
+
+         HLPR_BAIL;
+      }
+   }
+
+   pCallout = &(pPolicy->pCallouts[pPolicy->numCallouts]);
+
+   pCallout->calloutKey              = calloutKey;
+   pCallout->displayData.name        = (PWSTR)pName;
+   pCallout->displayData.description = (PWSTR)pDescription;
+   pCallout->providerKey             = (GUID*)&WFPSAMPLER_PROVIDER;
+   pCallout->applicableLayer         = pFilter->layerKey;
+   pCallout->flags                   = flags;
+
+   pPolicy->numCallouts++;
+
+   HLPR_BAIL_LABEL:
+
+   return;
+}
+
+/**
+ @private_function="PrvHlprBulkLoadRuleParse"
+
+   Purpose:  Turn one line of the rule file into a filter.                                      <br>
+                                                                                                <br>
+   Notes:    A rule is an action (BLOCK, PERMIT or CONTINUE) followed by the same parameters
+             the BASIC_ACTION scenarios take on the command line, i.e.                          <br>
+                BLOCK -l FWPM_LAYER_ALE_AUTH_CONNECT_V4 -ipp 6 -iprp 443                         <br>
+             Tokens are whitespace separated, so values may not contain spaces.  The line is
+             tokenized in place, and the tokens must outlive the filter.                        <br>
+                                                                                                <br>
+   MSDN_Ref:                                                                                    <br>
+*/
+_Success_(return == NO_ERROR)
+UINT32 PrvHlprBulkLoadRuleParse(_Inout_ PWSTR pLine,
+                                _Inout_ BULK_LOAD_POLICY* pPolicy,
+                                _Inout_ BULK_LOAD_RULE* pRule)
+{
+   ASSERT(pLine);
+   ASSERT(pPolicy);
+   ASSERT(pRule);
+
+   UINT32          status                         = NO_ERROR;
+   PCWSTR          ppTokens[BULK_LOAD_MAX_TOKENS] = {0};
+   UINT32          numTokens                      = 0;
+   size_t          ruleTextSize                   = 0;
+   PWSTR           pContext                       = 0;
+   FWP_ACTION_TYPE actionType                     = FWP_ACTION_BLOCK;
+
+   for(PWSTR pToken = wcstok_s(pLine,
+                               L" \t",
+                               &pContext);
+       pToken;
+       pToken = wcstok_s(0,
+                         L" \t",
+                         &pContext))
+   {
+      if(numTokens == BULK_LOAD_MAX_TOKENS)
+      {
+         status = ERROR_BUFFER_OVERFLOW;
+
+         HlprLogError(L"PrvHlprBulkLoadRuleParse : Too Many Tokens [status: %#x][max: %d]",
+                      status,
+                      BULK_LOAD_MAX_TOKENS);
+
+         HLPR_BAIL;
+      }
+
+      ppTokens[numTokens++] = pToken;
+
+      ruleTextSize += wcslen(pToken) + 1;
+   }
+
+   if(numTokens == 0)
+   {
+      status = ERROR_INVALID_PARAMETER;
+
+      HLPR_BAIL;
+   }
+
+   if(HlprStringsAreEqual(ppTokens[0],
+                          L"BLOCK"))
+      actionType = FWP_ACTION_BLOCK;
+   else if(HlprStringsAreEqual(ppTokens[0],
+                               L"PERMIT"))
+      actionType = FWP_ACTION_PERMIT;
+   else if(HlprStringsAreEqual(ppTokens[0],
+                               L"CONTINUE"))
+      actionType = FWP_ACTION_CONTINUE;
+   else
+   {
+      status = ERROR_INVALID_PARAMETER;
+
+      HlprLogError(L"PrvHlprBulkLoadRuleParse : Unknown Action [status: %#x][action: %s]",
+                   status,
+                   ppTokens[0]);
+
+      HLPR_BAIL;
+   }
+
+   HLPR_NEW_ARRAY(pRule->pRuleText,
+                  WCHAR,
+                  ruleTextSize);
+   HLPR_BAIL_ON_ALLOC_FAILURE(pRule->pRuleText,
+                              status);
+
+   for(UINT32 tokenIndex = 0;
+       tokenIndex < numTokens;
+       tokenIndex++)
+   {
+      if(tokenIndex)
+         StringCchCat(pRule->pRuleText,
+                      ruleTextSize,
+                      L" ");
+
+      StringCchCat(pRule->pRuleText,
+                   ruleTextSize,
+                   ppTokens[tokenIndex]);
+   }
+
+   /// The action token is not a parameter, so the parsers simply skip over it
+   status = HlprCommandLineParseForFilterInfo(ppTokens,
+                                              numTokens,
+                                              &(pRule->filter));
+   HLPR_BAIL_ON_FAILURE(status);
+
+   PrvHlprBulkLoadFilterKeyMake(pRule->pRuleText,
+                                &(pRule->filter.filterKey));
+
+   pRule->filter.displayData.name        = (PWSTR)g_pBulkLoadFilterName;
+   pRule->filter.displayData.description = pRule->pRuleText;
+   pRule->filter.providerKey             = (GUID*)&WFPSAMPLER_PROVIDER;
+   pRule->filter.weight.type             = FWP_UINT8;
+   pRule->filter.weight.uint8            = pRule->filter.numFilterConditions ? 0xF : 0x0;
+
+   if(pRule->filter.action.type & FWP_ACTION_FLAG_CALLOUT)
+      PrvHlprBulkLoadCalloutAdd(pPolicy,
+                                &(pRule->filter),
+                                actionType);
+   else
+      pRule->filter.action.type = actionType;
+
+   HLPR_BAIL_LABEL:
+
+   return status;
+}
+
+/**
+ @private_function="PrvHlprBulkLoadPolicyParse"
+
+   Purpose:  Parse every rule in the file, then sort the rules by filterKey.                    <br>
+                                                                                                <br>
+   Notes:    Blank lines, and lines starting with '#' or ';', are ignored.  A rule which fails
+             to parse fails the whole load before BFE is touched.                               <br>
+                                                                                                <br>
+   MSDN_Ref:                                                                                    <br>
+*/
+_Success_(return == NO_ERROR)
+UINT32 PrvHlprBulkLoadPolicyParse(_Inout_ BULK_LOAD_POLICY* pPolicy)
+{
+   ASSERT(pPolicy);
+   ASSERT(pPolicy->pFileText);
+
+   UINT32 status     = NO_ERROR;
+   UINT32 numLines   = 1;
+   UINT32 lineNumber = 0;
+   PWSTR  pLine      = pPolicy->pFileText;
+
+   for(PCWSTR pCharacter = pPolicy->pFileText;
+       *pCharacter;
+       pCharacter++)
+   {
+      if(*pCharacter == L'\n')
+         numLines++;
+   }
+
+   HLPR_NEW_ARRAY(pPolicy->pRules,
+                  BULK_LOAD_RULE,
+                  numLines);
+   HLPR_BAIL_ON_ALLOC_FAILURE(pPolicy->pRules,
+                              status);
+
+   pPolicy->maxRules = numLines;
+
+   HLPR_NEW_ARRAY(pPolicy->pCallouts,
+                  FWPM_CALLOUT,
+                  numLines);
+   HLPR_BAIL_ON_ALLOC_FAILURE(pPolicy->pCallouts,
+                              status);
+
+   while(pLine)
+   {
+      PWSTR pNextLine = wcschr(pLine,
+                               L'\n');
+
+      lineNumber++;
+
+      if(pNextLine)
+      {
+         *pNextLine = L'\0';
+
+         pNextLine++;
+      }
+
+      for(PWSTR pCharacter = pLine;
+          *pCharacter;
+          pCharacter++)
+      {
+         if(*pCharacter == L'\r')
+            *pCharacter = L' ';
+      }
+
+      while(*pLine == L' ' ||
+            *pLine == L'\t')
+         pLine++;
+
+      if(*pLine != L'\0' &&
+         *pLine != L'#' &&
+         *pLine != L';')
+      {
+         status = PrvHlprBulkLoadRuleParse(pLine,
+                                           pPolicy,
+                                           &(pPolicy->pRules[pPolicy->numRules]));
+         if(status != NO_ERROR)
+         {
+            HlprLogError(L"PrvHlprBulkLoadPolicyParse : PrvHlprBulkLoadRuleParse() [status: %#x][line: %d]",
+                         status,
+                         lineNumber);
+
+            HLPR_BAIL;
+         }
+
+         pPolicy->numRules++;
+      }
+
+      pLine = pNextLine;
+   }
+
+   qsort(pPolicy->pRules,
+         pPolicy->numRules,
+         sizeof(BULK_LOAD_RULE),
+         PrvHlprBulkLoadRuleCompare);
+
+   /// Identical rules hash to the same key; only the first of them gets added
+   for(UINT32 ruleIndex = 1;
+       ruleIndex < pPolicy->numRules;
+       ruleIndex++)
+   {
+      if(HlprGUIDsAreEqual(&(pPolicy->pRules[ruleIndex - 1].filter.filterKey),
+                           &(pPolicy->pRules[ruleIndex].filter.filterKey)))
+      {
+         pPolicy->pRules[ruleIndex].isInstalled = TRUE;
+
+         pPolicy->numDuplicates++;
+      }
+   }
+
+   HLPR_BAIL_LABEL:
+
+   return status;
+}
+
+/**
+ @private_function="PrvHlprBulkLoadInstalledFiltersMatch"
+
+   Purpose:  Enumerate the bulk load filters already in BFE.  Those matching a rule mark the
+             rule as installed, and if requested, the rest are collected for deletion.          <br>
+                                                                                                <br>
+   Notes:    Filters are enumerated per layer, as PrvCleanPolicy does.                          <br>
+                                                                                                <br>
+   MSDN_Ref: HTTP://MSDN.Microsoft.com/En-US/Library/Windows/Desktop/AA364089.aspx              <br>
+*/
+_Success_(return == NO_ERROR)
+UINT32 PrvHlprBulkLoadInstalledFiltersMatch(_In_ HANDLE engineHandle,
+                                            _Inout_ BULK_LOAD_POLICY* pPolicy,
+                                            _In_ BOOLEAN collectStaleFilters)
+{
+   ASSERT(engineHandle);
+   ASSERT(pPolicy);
+
+   UINT32                    status             = NO_ERROR;
+   HANDLE                    enumHandle         = 0;
+   UINT32                    numEntries         = 0;
+   FWPM_FILTER**             ppFilters          = 0;
+   FWPM_FILTER_ENUM_TEMPLATE filterEnumTemplate = {0};
+
+   filterEnumTemplate.providerKey = (GUID*)&WFPSAMPLER_PROVIDER;
+   filterEnumTemplate.enumType    = FWP_FILTER_ENUM_FULLY_CONTAINED;
+   filterEnumTemplate.flags       = FWP_FILTER_ENUM_FLAG_INCLUDE_BOOTTIME |
+                                    FWP_FILTER_ENUM_FLAG_INCLUDE_DISABLED;
+   filterEnumTemplate.actionMask  = 0xFFFFFFFF;
+
+   for(UINT32 layerIndex = 0;
+       layerIndex < RTL_NUMBER_OF(ppLayerKeyArray);
+       layerIndex++)
+   {
+      filterEnumTemplate.layerKey = *(ppLayerKeyArray[layerIndex]);
+
+      /// Layers unavailable on this version of Windows can not hold any of our filters
+      if(HlprFwpmFilterCreateEnumHandle(engineHandle,
+                                        &filterEnumTemplate,
+                                        &enumHandle) != NO_ERROR)
+         continue;
+
+      status = HlprFwpmFilterEnum(engineHandle,
+                                  enumHandle,
+                                  0xFFFFFFFF,
+                                  &ppFilters,
+                                  &numEntries);
+
+      HlprFwpmFilterDestroyEnumHandle(engineHandle,
+                                      &enumHandle);
+
+      HLPR_BAIL_ON_FAILURE(status);
+
+      for(UINT32 filterIndex = 0;
+          ppFilters &&
+          filterIndex < numEntries;
+          filterIndex++)
+      {
+         BULK_LOAD_RULE* pRule = 0;
+
+         if(!HlprStringsAreEqual(ppFilters[filterIndex]->displayData.name,
+                                 g_pBulkLoadFilterName))
+            continue;
+
+         pRule = PrvHlprBulkLoadRuleFind(pPolicy,
+                                         &(ppFilters[filterIndex]->filterKey));
+         if(pRule)
+            pRule->isInstalled = TRUE;
+         else if(collectStaleFilters)
+         {
+            if(pPolicy->numStaleFilterKeys == pPolicy->maxStaleFilterKeys)
+            {
+               UINT32 maxKeys = pPolicy->maxStaleFilterKeys ? pPolicy->maxStaleFilterKeys * 2 : 256;
+               GUID*  pKeys   = 0;
+
+               HLPR_NEW_ARRAY(pKeys,
+                              GUID,
+                              maxKeys);
+               HLPR_BAIL_ON_ALLOC_FAILURE(pKeys,
+                                          status);
+
+               if(pPolicy->numStaleFilterKeys)
+                  RtlCopyMemory(pKeys,
+                                pPolicy->pStaleFilterKeys,
+                                pPolicy->numStaleFilterKeys * sizeof(GUID));
+
+               HLPR_DELETE_ARRAY(pPolicy->pStaleFilterKeys);
+
+               pPolicy->pStaleFilterKeys   = pKeys;
+               pPolicy->maxStaleFilterKeys = maxKeys;
+            }
+
+            pPolicy->pStaleFilterKeys[pPolicy->numStaleFilterKeys] = ppFilters[filterIndex]->filterKey;
+
+            pPolicy->numStaleFilterKeys++;
+         }
+      }
+
+      if(ppFilters)
+         FwpmFreeMemory((VOID**)&ppFilters);
+
+      numEntries = 0;
+   }
+
+   HLPR_BAIL_LABEL:
+
+   if(ppFilters)
+      FwpmFreeMemory((VOID**)&ppFilters);
+
+   return status;
+}
+
+/**
+ @private_function="PrvHlprBulkLoadPolicyPurge"
+
+   Purpose:  Free everything allocated while loading the rule file.                             <br>
+                                                                                                <br>
+   Notes:                                                                                       <br>
+                                                                                                <br>
+   MSDN_Ref:                                                                                    <br>
+*/
+VOID PrvHlprBulkLoadPolicyPurge(_Inout_ BULK_LOAD_POLICY* pPolicy)
+{
+   ASSERT(pPolicy);
+
+   /// maxRules, not numRules, so a rule that failed halfway through parsing is cleaned up too
+   for(UINT32 ruleIndex = 0;
+       pPolicy->pRules &&
+       ruleIndex < pPolicy->maxRules;
+       ruleIndex++)
+   {
+      HlprFwpmFilterPurge(&(pPolicy->pRules[ruleIndex].filter));
+
+      HLPR_DELETE_ARRAY(pPolicy->pRules[ruleIndex].pRuleText);
+   }
+
+   HLPR_DELETE_ARRAY(pPolicy->pStaleFilterKeys);
+
+   HLPR_DELETE_ARRAY(pPolicy->pCallouts);
+
+   HLPR_DELETE_ARRAY(pPolicy->pRules);
+
+   HLPR_DELETE_ARRAY(pPolicy->pFileText);
+
+   ZeroMemory(pPolicy,
+              sizeof(BULK_LOAD_POLICY));
+
+   return;
+}
+
+/**
+ @helper_function="HlprBulkLoadExecute"
+
+   Purpose:  Load the rule file specified on the command line into BFE.                         <br>
+                -bulk <file>   - the rule file to load.                                         <br>
+                -reload        - also delete bulk load filters which are no longer in the file. <br>
+                -batch <count> - operations per transaction [Optional].                         <br>
+                                                                                                <br>
+   Notes:    WFPSampler's provider and sublayer, and the callouts referenced by the rules, are
+             added first.  Filters which BFE already has are left untouched, so a reload of an
+             edited file only deletes and adds the rules that changed.                          <br>
+                                                                                                <br>
+             The rate is reported over all rules in the file, from opening the engine to the
+             final commit.                                                                      <br>
+                                                                                                <br>
+   MSDN_Ref: HTTP://MSDN.Microsoft.com/En-US/Library/Windows/Desktop/AA364245.aspx              <br>
+*/
+_Success_(return == NO_ERROR)
+UINT32 HlprBulkLoadExecute(_In_reads_(stringCount) PCWSTR* ppCLPStrings,
+                           _In_ UINT32 stringCount)
+{
+   ASSERT(ppCLPStrings);
+   ASSERT(stringCount);
+
+   UINT32           status       = NO_ERROR;
+   PCWSTR           pFileName    = 0;
+   BOOLEAN          reload       = FALSE;
+   FWPM_PROVIDER*   pProvider    = 0;
+   FWPM_SUBLAYER*   pSubLayer    = 0;
+   UINT32           numAdded     = 0;
+   UINT32           numRemoved   = 0;
+   UINT32           numUnchanged = 0;
+   UINT64           elapsedTime  = 0;
+   LARGE_INTEGER    frequency    = {0};
+   LARGE_INTEGER    startTime    = {0};
+   LARGE_INTEGER    endTime      = {0};
+   BULK_LOAD_POLICY policy       = {0};
+   BULK_LOAD_BATCH  batch        = {0};
+
+   batch.batchSize = BULK_LOAD_DEFAULT_BATCH_SIZE;
+
+   for(UINT32 stringIndex = 0;
+       stringIndex < stringCount;
+       stringIndex++)
+   {
+      if(HlprStringsAreEqual(ppCLPStrings[stringIndex],
+                             L"-bulk") ||
+         HlprStringsAreEqual(ppCLPStrings[stringIndex],
+                             L"/bulk"))
+      {
+         if((stringIndex + 1) < stringCount)
+            pFileName = ppCLPStrings[++stringIndex];
+      }
+      else if(HlprStringsAreEqual(ppCLPStrings[stringIndex],
+                                  L"-reload") ||
+              HlprStringsAreEqual(ppCLPStrings[stringIndex],
+                                  L"/reload"))
+         reload = TRUE;
+      else if(HlprStringsAreEqual(ppCLPStrings[stringIndex],
+                                  L"-batch") ||
+              HlprStringsAreEqual(ppCLPStrings[stringIndex],
+                                  L"/batch"))
+      {
+         if((stringIndex + 1) < stringCount)
+         {
+            UINT32 batchSize = wcstoul(ppCLPStrings[++stringIndex],
+                                       0,
+                                       0);
+
+            if(batchSize)
+               batch.batchSize = batchSize;
+         }
+      }
+   }
+
+   if(pFileName == 0)
+   {
+      status = ERROR_INVALID_PARAMETER;
+
+      HlprLogError(L"HlprBulkLoadExecute : No Rule File Specified [status: %#x]",
+                   status);
+
+      HLPR_BAIL;
+   }
+
+   status = PrvHlprBulkLoadFileRead(pFileName,
+                                    &(policy.pFileText));
+   HLPR_BAIL_ON_FAILURE(status);
+
+   status = PrvHlprBulkLoadPolicyParse(&policy);
+   HLPR_BAIL_ON_FAILURE(status);
+
+   QueryPerformanceFrequency(&frequency);
+
+   QueryPerformanceCounter(&startTime);
+
+   status = HlprFwpmEngineOpen(&(batch.engineHandle));
+   HLPR_BAIL_ON_FAILURE(status);
+
+   status = PrvHlprBulkLoadInstalledFiltersMatch(batch.engineHandle,
+                                                 &policy,
+                                                 reload);
+   HLPR_BAIL_ON_FAILURE(status);
+
+   status = PrvHlprBulkLoadBatchPrepare(&batch);
+   HLPR_BAIL_ON_FAILURE(status);
+
+   /// Make sure WFPSampler's provider is available.  If not, create it.
+   status = FwpmProviderGetByKey(batch.engineHandle,
+                                 &WFPSAMPLER_PROVIDER,
+                                 &pProvider);
+   if(status == FWP_E_PROVIDER_NOT_FOUND)
+   {
+      status = HlprFwpmProviderAdd(batch.engineHandle,
+                                   &WFPSAMPLER_PROVIDER,
+                                   g_pCompanyName,
+                                   g_pBinaryDescription,
+                                   g_pServiceName,
+                                   FWPM_PROVIDER_FLAG_PERSISTENT);
+      HLPR_BAIL_ON_FAILURE(status);
+
+      status = PrvHlprBulkLoadBatchAdvance(&batch);
+      HLPR_BAIL_ON_FAILURE(status);
+   }
+   else
+      FwpmFreeMemory((VOID**)&pProvider);
+
+   status = PrvHlprBulkLoadBatchPrepare(&batch);
+   HLPR_BAIL_ON_FAILURE(status);
+
+   /// Make sure WFPSampler's subLayer is available.  If not, create it.
+   status = FwpmSubLayerGetByKey(batch.engineHandle,
+                                 &WFPSAMPLER_SUBLAYER,
+                                 &pSubLayer);
+   if(status == FWP_E_SUBLAYER_NOT_FOUND)
+   {
+      status = HlprFwpmSubLayerAdd(batch.engineHandle,
+                                   &WFPSAMPLER_SUBLAYER,
+                                   L"WFP Sampler's default subLayer",
+                                   &WFPSAMPLER_PROVIDER,
+                                   0x7FFE,
+                                   FWPM_SUBLAYER_FLAG_PERSISTENT);
+      HLPR_BAIL_ON_FAILURE(status);
+
+      status = PrvHlprBulkLoadBatchAdvance(&batch);
+      HLPR_BAIL_ON_FAILURE(status);
+   }
+   else
+      FwpmFreeMemory((VOID**)&pSubLayer);
+
+   for(UINT32 calloutIndex = 0;
+       calloutIndex < policy.numCallouts;
+       calloutIndex++)
+   {
+      FWPM_CALLOUT* pCallout = 0;
+
+      status = PrvHlprBulkLoadBatchPrepare(&batch);
+      HLPR_BAIL_ON_FAILURE(status);
+
+      status = FwpmCalloutGetByKey(batch.engineHandle,
+                                   &(policy.pCallouts[calloutIndex].calloutKey),
+                                   &pCallout);
+      if(status == FWP_E_CALLOUT_NOT_FOUND)
+      {
+         status = HlprFwpmCalloutAdd(batch.engineHandle,
+                                     &(policy.pCallouts[calloutIndex]));
+         HLPR_BAIL_ON_FAILURE(status);
+
+         status = PrvHlprBulkLoadBatchAdvance(&batch);
+         HLPR_BAIL_ON_FAILURE(status);
+      }
+      else
+         FwpmFreeMemory((VOID**)&pCallout);
+   }
+
+   for(UINT32 keyIndex = 0;
+       keyIndex < policy.numStaleFilterKeys;
+       keyIndex++)
+   {
+      status = PrvHlprBulkLoadBatchPrepare(&batch);
+      HLPR_BAIL_ON_FAILURE(status);
+
+      status = HlprFwpmFilterDeleteByKey(batch.engineHandle,
+                                         &(policy.pStaleFilterKeys[keyIndex]));
+      HLPR_BAIL_ON_FAILURE(status);
+
+      status = PrvHlprBulkLoadBatchAdvance(&batch);
+      HLPR_BAIL_ON_FAILURE(status);
+
+      numRemoved++;
+   }
+
+   for(UINT32 ruleIndex = 0;
+       ruleIndex < policy.numRules;
+       ruleIndex++)
+   {
+      if(policy.pRules[ruleIndex].isInstalled)
+      {
+         numUnchanged++;
+
+         continue;
+      }
+
+      status = PrvHlprBulkLoadBatchPrepare(&batch);
+      HLPR_BAIL_ON_FAILURE(status);
+
+      status = HlprFwpmFilterAdd(batch.engineHandle,
+                                 &(policy.pRules[ruleIndex].filter));
+      if(status != NO_ERROR)
+      {
+         HlprLogError(L"HlprBulkLoadExecute : HlprFwpmFilterAdd() [status: %#x][rule: %s]",
+                      status,
+                      policy.pRules[ruleIndex].pRuleText);
+
+         HLPR_BAIL;
+      }
+
+      status = PrvHlprBulkLoadBatchAdvance(&batch);
+      HLPR_BAIL_ON_FAILURE(status);
+
+      numAdded++;
+   }
+
+   status = PrvHlprBulkLoadBatchFinish(&batch,
+                                       status);
+   HLPR_BAIL_ON_FAILURE(status);
+
+   QueryPerformanceCounter(&endTime);
+
+   elapsedTime = (UINT64)(endTime.QuadPart - startTime.QuadPart);
+
+   HlprLogInfo(L"HlprBulkLoadExecute : [rules: %d][added: %d][removed: %d][unchanged: %d][duplicates: %d][transactions: %d]",
+               policy.numRules,
+               numAdded,
+               numRemoved,
+               numUnchanged - policy.numDuplicates,
+               policy.numDuplicates,
+               batch.numTransactions);
+
+   HlprLogInfo(L"HlprBulkLoadExecute : [milliseconds: %I64u][rules/s: %I64u]",
+               (elapsedTime * 1000) / (UINT64)frequency.QuadPart,
+               elapsedTime ? ((UINT64)policy.numRules * (UINT64)frequency.QuadPart) / elapsedTime : 0);
+
+   HLPR_BAIL_LABEL:
+
+   if(batch.engineHandle)
+   {
+      PrvHlprBulkLoadBatchFinish(&batch,
+                                 status);
+
+      HlprFwpmEngineClose(&(batch.engineHandle));
+   }
+
+   PrvHlprBulkLoadPolicyPurge(&policy);
+
+   return status;
+}
+
+/**
+ @helper_function="HlprBulkLoadLogHelp"
+
+   Purpose:  Log usage information for the bulk load command to the console.                   <br>
+                                                                                                <br>
+   Notes:                                                                                       <br>
+                                                                                                <br>
+   MSDN_Ref:                                                                                    <br>
+*/
+VOID HlprBulkLoadLogHelp()
+{
+   wprintf(L"\n\t\t -bulk  \t Load the rules in the specified file using batched transactions.");
+   wprintf(L"\n\t\t        \t    Each line is BLOCK, PERMIT or CONTINUE followed by BASIC_ACTION parameters.");
+   wprintf(L"\n\t\t        \t       i.e. BLOCK -l FWPM_LAYER_ALE_AUTH_CONNECT_V4 -ipp 6 -c");
+   wprintf(L"\n\t\t        \t    Lines starting with # or ; are ignored.  Rules already in BFE are left untouched.");
+   wprintf(L"\n\t\t -reload\t Used with -bulk.  Delete bulk loaded filters which are no longer in the file. [Optional]");
+   wprintf(L"\n\t\t -batch \t Used with -bulk.  Number of objects per transaction (default %d). [Optional]",
+           BULK_LOAD_DEFAULT_BATCH_SIZE);
+
+   return;
+}
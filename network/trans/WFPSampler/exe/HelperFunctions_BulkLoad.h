@@ -0,0 +1,34 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//   Copyright (c) 2014 Microsoft Corporation.  All Rights Reserved.
+//
+//   Module Name:
+//      HelperFunctions_BulkLoad.h
+//
+//   Abstract:
+//      This module contains functions which assist in loading a file of filter rules into BFE
+//         using batched transactions.
+//
+//   Author:
+//      Dusty Harper      (DHarper)
+//
+//   Revision History:
+//
+//      [ Month ][Day] [Year] - [Revision]-[ Comments ]
+//      May       01,   2010  -     1.0   -  Creation
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef HELPERFUNCTIONS_BULK_LOAD_H
+#define HELPERFUNCTIONS_BULK_LOAD_H
+
+#define BULK_LOAD_DEFAULT_BATCH_SIZE 4096 /// objects added or deleted per BFE transaction
+#define BULK_LOAD_MAX_TOKENS         128  /// tokens allowed on a single rule line
+
+_Success_(return == NO_ERROR)
+UINT32 HlprBulkLoadExecute(_In_reads_(stringCount) PCWSTR* ppCLPStrings,
+                           _In_ UINT32 stringCount);
+
+VOID HlprBulkLoadLogHelp();
+
+#endif /// HELPERFUNCTIONS_BULK_LOAD_H
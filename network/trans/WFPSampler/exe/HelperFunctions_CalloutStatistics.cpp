@@ -0,0 +1,413 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//   Copyright (c) 2014 Microsoft Corporation.  All Rights Reserved.
+//
+//   Module Name:
+//      HelperFunctions_CalloutStatistics.cpp
+//
+//   Abstract:
+//      This module contains functions which retrieve the classify instrumentation kept by
+//         WFPSamplerCalloutDriver.sys and display it per callout family.
+//
+//   Naming Convention:
+//
+//      <Scope><Module><Object><Action><Modifier>
+//
+//      i.e.
+//
+//       <Scope>
+//          {
+//                                          - Function is likely visible to other modules.
+//            Prv                           - Function is private to this module.
+//          }
+//       <Module>
+//          {
+//            Hlpr                          - Function is from HelperFunctions_* Modules.
+//          }
+//       <Object>
+//          {
+//            CalloutStatistics             - Function pertains to the classify instrumentation.
+//          }
+//       <Action>
+//          {
+//            Execute            - Function carries out the -stats command.
+//            Get                - Function retrieves data from the driver.
+//            Log                - Function writes to the console.
+//            LogHelp            - Function writes usage information to the console.
+//          }
+//       <Modifier>
+//          {
+//            Percentile         - Function reports a percentile of the cycle histogram.
+//          }
+//
+//   Private Functions:
+//      PrvHlprCalloutStatisticsGet(),
+//      PrvHlprCalloutStatisticsLog(),
+//      PrvHlprCalloutStatisticsPercentile(),
+//
+//   Public Functions:
+//      HlprCalloutStatisticsExecute(),
+//      HlprCalloutStatisticsLogHelp(),
+//
+//   Author:
+//      Dusty Harper      (DHarper)
+//
+//   Revision History:
+//
+//      [ Month ][Day] [Year] - [Revision]-[ Comments ]
+//      May       01,   2010  -     1.0   -  Creation
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "Framework_WFPSampler.h" /// .
+
+/// Indexed by CALLOUT_STATISTICS_ID
+static PCWSTR ppCalloutStatisticsNames[CALLOUT_STATISTICS_MAX] = {L"ADVANCED_PACKET_INJECTION",
+                                                                  L"BASIC_ACTION_BLOCK",
+                                                                  L"BASIC_ACTION_CONTINUE",
+                                                                  L"BASIC_ACTION_PERMIT",
+                                                                  L"BASIC_ACTION_RANDOM",
+                                                                  L"BASIC_PACKET_EXAMINATION",
+                                                                  L"BASIC_PACKET_INJECTION",
+                                                                  L"BASIC_PACKET_MODIFICATION",
+                                                                  L"BASIC_STREAM_INJECTION",
+                                                                  L"FAST_PACKET_INJECTION",
+                                                                  L"FAST_STREAM_INJECTION",
+                                                                  L"FLOW_ASSOCIATION",
+                                                                  L"PEND_AUTHORIZATION",
+                                                                  L"PEND_ENDPOINT_CLOSURE",
+                                                                  L"PROXY_BY_INJECTION",
+                                                                  L"PROXY_BY_ALE_REDIRECT",
+                                                                 };
+
+/**
+ @private_function="PrvHlprCalloutStatisticsGet"
+
+   Purpose:  Retrieve the header and every processor's counters from the driver.               <br>
+                                                                                                <br>
+   Notes:    The first request only returns the header, which carries the size of the full
+             snapshot.                                                                          <br>
+                                                                                                <br>
+             Caller must free *ppBuffer using HLPR_DELETE_ARRAY.                                <br>
+                                                                                                <br>
+   MSDN_Ref: HTTP://MSDN.Microsoft.com/En-US/Library/Windows/Desktop/AA363216.aspx              <br>
+*/
+_Success_(return == NO_ERROR)
+UINT32 PrvHlprCalloutStatisticsGet(_In_ HANDLE deviceHandle,
+                                   _Outptr_result_bytebuffer_(*pBufferSize) BYTE** ppBuffer,
+                                   _Out_ UINT32* pBufferSize)
+{
+   ASSERT(deviceHandle);
+   ASSERT(ppBuffer);
+   ASSERT(pBufferSize);
+
+   UINT32                    status        = NO_ERROR;
+   DWORD                     bytesReturned = 0;
+   UINT32                    bufferSize    = 0;
+   CALLOUT_STATISTICS_HEADER header        = {0};
+
+   *ppBuffer    = 0;
+   *pBufferSize = 0;
+
+   if(!DeviceIoControl(deviceHandle,
+                       IOCTL_WFPSAMPLER_QUERY_CALLOUT_STATISTICS,
+                       0,
+                       0,
+                       &header,
+                       sizeof(header),
+                       &bytesReturned,
+                       0))
+   {
+      status = GetLastError();
+      if(status != ERROR_MORE_DATA)
+         HLPR_BAIL;
+
+      status = NO_ERROR;
+   }
+
+   if(bytesReturned < sizeof(header) ||
+      header.calloutCount != CALLOUT_STATISTICS_MAX ||
+      header.histogramBuckets != CALLOUT_STATISTICS_HISTOGRAM_BUCKETS)
+   {
+      status = ERROR_REVISION_MISMATCH;
+
+      HlprLogError(L"PrvHlprCalloutStatisticsGet : Unexpected Header [status: %#x][callouts: %d][buckets: %d]",
+                   status,
+                   header.calloutCount,
+                   header.histogramBuckets);
+
+      HLPR_BAIL;
+   }
+
+   bufferSize = header.size;
+
+   HLPR_NEW_ARRAY(*ppBuffer,
+                  BYTE,
+                  bufferSize);
+   HLPR_BAIL_ON_ALLOC_FAILURE(*ppBuffer,
+                              status);
+
+   if(!DeviceIoControl(deviceHandle,
+                       IOCTL_WFPSAMPLER_QUERY_CALLOUT_STATISTICS,
+                       0,
+                       0,
+                       *ppBuffer,
+                       bufferSize,
+                       &bytesReturned,
+                       0))
+   {
+      /// ERROR_MORE_DATA here means the processor count changed between the two requests
+      status = GetLastError();
+
+      HLPR_BAIL;
+   }
+
+   *pBufferSize = bytesReturned;
+
+   HLPR_BAIL_LABEL:
+
+   if(status != NO_ERROR)
+   {
+      HlprLogError(L"PrvHlprCalloutStatisticsGet : DeviceIoControl() [status: %#x]",
+                   status);
+
+      HLPR_DELETE_ARRAY(*ppBuffer);
+   }
+
+   return status;
+}
+
+/**
+ @private_function="PrvHlprCalloutStatisticsPercentile"
+
+   Purpose:  Return the upper bound, in cycles, of the histogram bucket holding the requested
+             percentile of the classifies.                                                      <br>
+                                                                                                <br>
+   Notes:    Returns 0 if the percentile falls in the open ended last bucket.                   <br>
+                                                                                                <br>
+   MSDN_Ref:                                                                                    <br>
+*/
+UINT64 PrvHlprCalloutStatisticsPercentile(_In_reads_(CALLOUT_STATISTICS_HISTOGRAM_BUCKETS) const UINT64* pHistogram,
+                                          _In_ UINT64 invocations,
+                                          _In_ UINT32 percentile)
+{
+   ASSERT(pHistogram);
+
+   UINT64 total = 0;
+
+   for(UINT32 bucket = 0;
+       bucket < CALLOUT_STATISTICS_HISTOGRAM_BUCKETS - 1;
+       bucket++)
+   {
+      total += pHistogram[bucket];
+
+      if(total * 100 >= invocations * percentile)
+         return 2ULL << bucket;
+   }
+
+   return 0;
+}
+
+/**
+ @private_function="PrvHlprCalloutStatisticsLog"
+
+   Purpose:  Sum each callout family's counters across processors and write them to the
+             console.                                                                           <br>
+                                                                                                <br>
+   Notes:    Families which were never invoked are skipped.                                     <br>
+                                                                                                <br>
+   MSDN_Ref:                                                                                    <br>
+*/
+VOID PrvHlprCalloutStatisticsLog(_In_reads_bytes_(bufferSize) const BYTE* pBuffer,
+                                 _In_ UINT32 bufferSize)
+{
+   ASSERT(pBuffer);
+
+   const CALLOUT_STATISTICS_HEADER*   pHeader       = (const CALLOUT_STATISTICS_HEADER*)pBuffer;
+   const CALLOUT_STATISTICS_COUNTERS* pCounters     = (const CALLOUT_STATISTICS_COUNTERS*)(pBuffer + sizeof(CALLOUT_STATISTICS_HEADER));
+   UINT32                             numProcessors = (UINT32)((bufferSize - sizeof(CALLOUT_STATISTICS_HEADER)) /
+                                                               (sizeof(CALLOUT_STATISTICS_COUNTERS) * CALLOUT_STATISTICS_MAX));
+   UINT32                             numInvoked    = 0;
+
+   if(numProcessors > pHeader->processorCount)
+      numProcessors = pHeader->processorCount;
+
+   wprintf(L"\n\t %-26s %18s %14s %12s %12s %12s",
+           L"Callout",
+           L"Invocations",
+           L"Pends",
+           L"Avg Cycles",
+           L"p50 Cycles",
+           L"p99 Cycles");
+
+   for(UINT32 calloutId = 0;
+       calloutId < CALLOUT_STATISTICS_MAX;
+       calloutId++)
+   {
+      CALLOUT_STATISTICS_COUNTERS totals = {0};
+
+      for(UINT32 processorIndex = 0;
+          processorIndex < numProcessors;
+          processorIndex++)
+      {
+         const CALLOUT_STATISTICS_COUNTERS* pProcessorCounters = &(pCounters[(processorIndex * CALLOUT_STATISTICS_MAX) + calloutId]);
+
+         totals.invocations += pProcessorCounters->invocations;
+         totals.pends       += pProcessorCounters->pends;
+         totals.cycles      += pProcessorCounters->cycles;
+
+         for(UINT32 bucket = 0;
+             bucket < CALLOUT_STATISTICS_HISTOGRAM_BUCKETS;
+             bucket++)
+         {
+            totals.pHistogram[bucket] += pProcessorCounters->pHistogram[bucket];
+         }
+      }
+
+      if(totals.invocations == 0)
+         continue;
+
+      numInvoked++;
+
+      wprintf(L"\n\t %-26s %18I64u %14I64u %12I64u %12I64u %12I64u",
+              ppCalloutStatisticsNames[calloutId],
+              totals.invocations,
+              totals.pends,
+              totals.cycles / totals.invocations,
+              PrvHlprCalloutStatisticsPercentile(totals.pHistogram,
+                                                 totals.invocations,
+                                                 50),
+              PrvHlprCalloutStatisticsPercentile(totals.pHistogram,
+                                                 totals.invocations,
+                                                 99));
+   }
+
+   if(numInvoked == 0)
+      wprintf(L"\n\t No classifies have been recorded.");
+
+   wprintf(L"\n\n\t [processors: %d]  Percentiles are histogram bucket upper bounds; 0 means beyond 2^%d cycles.\n",
+           numProcessors,
+           CALLOUT_STATISTICS_HISTOGRAM_BUCKETS - 1);
+
+   return;
+}
+
+/**
+ @helper_function="HlprCalloutStatisticsExecute"
+
+   Purpose:  Display the per callout invocation, pend and cycle counters kept by
+             WFPSamplerCalloutDriver.sys, optionally zeroing them afterwards.                   <br>
+                                                                                                <br>
+   Notes:    Talks to the driver directly, so the WFPSampler service is not needed.             <br>
+                                                                                                <br>
+   MSDN_Ref: HTTP://MSDN.Microsoft.com/En-US/Library/Windows/Desktop/AA363858.aspx              <br>
+             HTTP://MSDN.Microsoft.com/En-US/Library/Windows/Desktop/AA363216.aspx              <br>
+*/
+_Success_(return == NO_ERROR)
+UINT32 HlprCalloutStatisticsExecute(_In_reads_(stringCount) PCWSTR* ppCLPStrings,
+                                    _In_ UINT32 stringCount)
+{
+   ASSERT(ppCLPStrings);
+   ASSERT(stringCount);
+
+   UINT32  status        = NO_ERROR;
+   BOOLEAN reset         = FALSE;
+   HANDLE  deviceHandle  = 0;
+   BYTE*   pBuffer       = 0;
+   UINT32  bufferSize    = 0;
+   DWORD   bytesReturned = 0;
+
+   for(UINT32 stringIndex = 0;
+       stringIndex < stringCount;
+       stringIndex++)
+   {
+      if(HlprStringsAreEqual(ppCLPStrings[stringIndex],
+                             L"-reset") ||
+         HlprStringsAreEqual(ppCLPStrings[stringIndex],
+                             L"/reset"))
+         reset = TRUE;
+   }
+
+   deviceHandle = CreateFile(WFPSAMPLER_USER_DEVICE_NAME,
+                             GENERIC_READ | GENERIC_WRITE,
+                             0,
+                             0,
+                             OPEN_EXISTING,
+                             FILE_ATTRIBUTE_NORMAL,
+                             0);
+   if(deviceHandle == INVALID_HANDLE_VALUE)
+   {
+      deviceHandle = 0;
+
+      status = GetLastError();
+
+      HlprLogError(L"HlprCalloutStatisticsExecute : CreateFile() [status: %#x][device: %s]",
+                   status,
+                   WFPSAMPLER_USER_DEVICE_NAME);
+
+      HLPR_BAIL;
+   }
+
+   status = PrvHlprCalloutStatisticsGet(deviceHandle,
+                                        &pBuffer,
+                                        &bufferSize);
+   HLPR_BAIL_ON_FAILURE(status);
+
+   PrvHlprCalloutStatisticsLog(pBuffer,
+                               bufferSize);
+
+   if(reset)
+   {
+      if(!DeviceIoControl(deviceHandle,
+                          IOCTL_WFPSAMPLER_RESET_CALLOUT_STATISTICS,
+                          0,
+                          0,
+                          0,
+                          0,
+                          &bytesReturned,
+                          0))
+      {
+         status = GetLastError();
+
+         HlprLogError(L"HlprCalloutStatisticsExecute : DeviceIoControl() [status: %#x]",
+                      status);
+
+         HLPR_BAIL;
+      }
+
+      HlprLogInfo(L"HlprCalloutStatisticsExecute : Counters Reset");
+   }
+
+   HLPR_BAIL_LABEL:
+
+   if(status == ERROR_NOT_SUPPORTED)
+   {
+      wprintf(L"\n\t Callout statistics are not enabled.  To enable them, run the following and restart WFPSamplerCallouts:");
+      wprintf(L"\n\t\t reg add HKLM\\System\\CurrentControlSet\\Services\\WFPSamplerCallouts\\Parameters /v %s /t REG_DWORD /d 1\n",
+              WFPSAMPLER_CALLOUT_STATISTICS_VALUE_NAME);
+   }
+
+   HLPR_CLOSE_HANDLE(deviceHandle);
+
+   HLPR_DELETE_ARRAY(pBuffer);
+
+   return status;
+}
+
+/**
+ @helper_function="HlprCalloutStatisticsLogHelp"
+
+   Purpose:  Log usage information for the stats command to the console.                       <br>
+                                                                                                <br>
+   Notes:                                                                                       <br>
+                                                                                                <br>
+   MSDN_Ref:                                                                                    <br>
+*/
+VOID HlprCalloutStatisticsLogHelp()
+{
+   wprintf(L"\n\t\t -stats \t Display per callout invocations, pends and classify cycles.");
+   wprintf(L"\n\t\t        \t    Requires the CalloutStatistics REG_DWORD under the WFPSamplerCallouts service's Parameters key.");
+   wprintf(L"\n\t\t -reset \t Used with -stats.  Zero the counters after displaying them. [Optional]");
+
+   return;
+}
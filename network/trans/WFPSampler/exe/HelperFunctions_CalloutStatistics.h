@@ -0,0 +1,31 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//   Copyright (c) 2014 Microsoft Corporation.  All Rights Reserved.
+//
+//   Module Name:
+//      HelperFunctions_CalloutStatistics.h
+//
+//   Abstract:
+//      This module contains functions which retrieve and display the classify instrumentation
+//         kept by WFPSamplerCalloutDriver.sys.
+//
+//   Author:
+//      Dusty Harper      (DHarper)
+//
+//   Revision History:
+//
+//      [ Month ][Day] [Year] - [Revision]-[ Comments ]
+//      May       01,   2010  -     1.0   -  Creation
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef HELPERFUNCTIONS_CALLOUT_STATISTICS_H
+#define HELPERFUNCTIONS_CALLOUT_STATISTICS_H
+
+_Success_(return == NO_ERROR)
+UINT32 HlprCalloutStatisticsExecute(_In_reads_(stringCount) PCWSTR* ppCLPStrings,
+                                    _In_ UINT32 stringCount);
+
+VOID HlprCalloutStatisticsLogHelp();
+
+#endif /// HELPERFUNCTIONS_CALLOUT_STATISTICS_H
@@ -0,0 +1,79 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//   Copyright (c) 2012 Microsoft Corporation.  All Rights Reserved.
+//
+//   Module Name:
+//      CalloutStatistics.h
+//
+//   Abstract:
+//      This module contains global definitions of the classify instrumentation shared between
+//         WFPSamplerCalloutDriver.sys and WFPSampler.exe
+//
+//   Author:
+//      Dusty Harper      (DHarper)
+//
+//   Revision History:
+//
+//      [ Month ][Day] [Year] - [Revision]-[ Comments ]
+//      May       01,   2010  -     1.0   -  Creation
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef WFP_SAMPLER_CALLOUT_STATISTICS_H
+#define WFP_SAMPLER_CALLOUT_STATISTICS_H
+
+#define WFPSAMPLER_DEVICE_NAME                L"\\Device\\WFPSamplerCallouts"
+#define WFPSAMPLER_SYMBOLIC_LINK_NAME         L"\\DosDevices\\Global\\WFPSamplerCallouts"
+#define WFPSAMPLER_USER_DEVICE_NAME           L"\\\\.\\WFPSamplerCallouts"
+
+/// REG_DWORD under HKLM\System\CurrentControlSet\Services\WFPSamplerCallouts\Parameters.  Non-zero
+/// wraps every classifyFn with the instrumentation below the next time the driver loads.
+#define WFPSAMPLER_CALLOUT_STATISTICS_VALUE_NAME L"CalloutStatistics"
+
+#define IOCTL_WFPSAMPLER_QUERY_CALLOUT_STATISTICS CTL_CODE(FILE_DEVICE_NETWORK, 0x800, METHOD_BUFFERED, FILE_READ_ACCESS)
+#define IOCTL_WFPSAMPLER_RESET_CALLOUT_STATISTICS CTL_CODE(FILE_DEVICE_NETWORK, 0x801, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+
+/// Bucket N counts the classifies which took [2^N, 2^(N + 1)) cycles; the last bucket is open ended
+#define CALLOUT_STATISTICS_HISTOGRAM_BUCKETS 32
+
+/// One entry per family of classifyFns exposed by WFPSamplerCalloutDriver.sys
+typedef enum CALLOUT_STATISTICS_ID_
+{
+   CALLOUT_STATISTICS_ADVANCED_PACKET_INJECTION = 0,
+   CALLOUT_STATISTICS_BASIC_ACTION_BLOCK,
+   CALLOUT_STATISTICS_BASIC_ACTION_CONTINUE,
+   CALLOUT_STATISTICS_BASIC_ACTION_PERMIT,
+   CALLOUT_STATISTICS_BASIC_ACTION_RANDOM,
+   CALLOUT_STATISTICS_BASIC_PACKET_EXAMINATION,
+   CALLOUT_STATISTICS_BASIC_PACKET_INJECTION,
+   CALLOUT_STATISTICS_BASIC_PACKET_MODIFICATION,
+   CALLOUT_STATISTICS_BASIC_STREAM_INJECTION,
+   CALLOUT_STATISTICS_FAST_PACKET_INJECTION,
+   CALLOUT_STATISTICS_FAST_STREAM_INJECTION,
+   CALLOUT_STATISTICS_FLOW_ASSOCIATION,
+   CALLOUT_STATISTICS_PEND_AUTHORIZATION,
+   CALLOUT_STATISTICS_PEND_ENDPOINT_CLOSURE,
+   CALLOUT_STATISTICS_PROXY_BY_INJECTION,
+   CALLOUT_STATISTICS_PROXY_BY_ALE_REDIRECT,
+   CALLOUT_STATISTICS_MAX
+}CALLOUT_STATISTICS_ID;
+
+typedef struct CALLOUT_STATISTICS_COUNTERS_
+{
+   UINT64 invocations; /// times the classifyFn was called
+   UINT64 pends;       /// classifies which returned with FWPS_CLASSIFY_OUT_FLAG_ABSORB set
+   UINT64 cycles;      /// total cycles spent inside the classifyFn
+   UINT64 pHistogram[CALLOUT_STATISTICS_HISTOGRAM_BUCKETS];
+}CALLOUT_STATISTICS_COUNTERS, *PCALLOUT_STATISTICS_COUNTERS;
+
+/// Returned by IOCTL_WFPSAMPLER_QUERY_CALLOUT_STATISTICS and followed by
+/// processorCount * calloutCount CALLOUT_STATISTICS_COUNTERS, grouped by processor.
+typedef struct CALLOUT_STATISTICS_HEADER_
+{
+   UINT32 size;             /// bytes needed for the header and all of the counters
+   UINT32 processorCount;
+   UINT32 calloutCount;
+   UINT32 histogramBuckets;
+}CALLOUT_STATISTICS_HEADER, *PCALLOUT_STATISTICS_HEADER;
+
+#endif /// WFP_SAMPLER_CALLOUT_STATISTICS_H
@@ -576,17 +576,10 @@ NTSTATUS PerformBasicPacketInjectionAtInboundMACFrame(_In_ CLASSIFY_DATA** ppCla
 
 #endif /// DBG
 
-#pragma warning(push)
-#pragma warning(disable: 6014) /// pCompletionData will be freed in completionFn using BasicPacketInjectionCompletionDataDestroy
-
-   HLPR_NEW(pCompletionData,
-            BASIC_PACKET_INJECTION_COMPLETION_DATA,
-            WFPSAMPLER_CALLOUT_DRIVER_TAG);
+   pCompletionData = (BASIC_PACKET_INJECTION_COMPLETION_DATA*)KrnlHlprCompletionPoolAcquire(g_pBPICompletionPool);
    HLPR_BAIL_ON_ALLOC_FAILURE(pCompletionData,
                               status);
 
-#pragma warning(pop)
-
    KeInitializeSpinLock(&(pCompletionData->spinLock));
 
    pCompletionData->performedInline = isInline;
@@ -795,17 +788,10 @@ NTSTATUS PerformBasicPacketInjectionAtOutboundMACFrame(_In_ CLASSIFY_DATA** ppCl
 
 #endif /// DBG
 
-#pragma warning(push)
-#pragma warning(disable: 6014) /// pCompletionData will be freed in completionFn using BasicPacketInjectionCompletionDataDestroy
-
-   HLPR_NEW(pCompletionData,
-            BASIC_PACKET_INJECTION_COMPLETION_DATA,
-            WFPSAMPLER_CALLOUT_DRIVER_TAG);
+   pCompletionData = (BASIC_PACKET_INJECTION_COMPLETION_DATA*)KrnlHlprCompletionPoolAcquire(g_pBPICompletionPool);
    HLPR_BAIL_ON_ALLOC_FAILURE(pCompletionData,
                               status);
 
-#pragma warning(pop)
-
    KeInitializeSpinLock(&(pCompletionData->spinLock));
 
    pCompletionData->performedInline = isInline;
@@ -982,17 +968,10 @@ NTSTATUS PerformBasicPacketInjectionAtIngressVSwitchEthernet(_In_ CLASSIFY_DATA*
 
 #endif /// DBG
 
-#pragma warning(push)
-#pragma warning(disable: 6014) /// pCompletionData will be freed in completionFn using BasicPacketInjectionCompletionDataDestroy
-
-   HLPR_NEW(pCompletionData,
-            BASIC_PACKET_INJECTION_COMPLETION_DATA,
-            WFPSAMPLER_CALLOUT_DRIVER_TAG);
+   pCompletionData = (BASIC_PACKET_INJECTION_COMPLETION_DATA*)KrnlHlprCompletionPoolAcquire(g_pBPICompletionPool);
    HLPR_BAIL_ON_ALLOC_FAILURE(pCompletionData,
                               status);
 
-#pragma warning(pop)
-
    KeInitializeSpinLock(&(pCompletionData->spinLock));
 
    pCompletionData->performedInline = isInline;
@@ -1183,17 +1162,10 @@ NTSTATUS PerformBasicPacketInjectionAtEgressVSwitchEthernet(_In_ CLASSIFY_DATA**
 
 #endif /// DBG
 
-#pragma warning(push)
-#pragma warning(disable: 6014) /// pCompletionData will be freed in completionFn using BasicPacketInjectionCompletionDataDestroy
-
-   HLPR_NEW(pCompletionData,
-            BASIC_PACKET_INJECTION_COMPLETION_DATA,
-            WFPSAMPLER_CALLOUT_DRIVER_TAG);
+   pCompletionData = (BASIC_PACKET_INJECTION_COMPLETION_DATA*)KrnlHlprCompletionPoolAcquire(g_pBPICompletionPool);
    HLPR_BAIL_ON_ALLOC_FAILURE(pCompletionData,
                               status);
 
-#pragma warning(pop)
-
    KeInitializeSpinLock(&(pCompletionData->spinLock));
 
    pCompletionData->performedInline = isInline;
@@ -1391,17 +1363,10 @@ NTSTATUS PerformBasicPacketInjectionAtInboundNetwork(_In_ CLASSIFY_DATA** ppClas
 
 #endif /// DBG
 
-#pragma warning(push)
-#pragma warning(disable: 6014) /// pCompletionData will be freed in completionFn using BasicPacketInjectionCompletionDataDestroy
-
-   HLPR_NEW(pCompletionData,
-            BASIC_PACKET_INJECTION_COMPLETION_DATA,
-            WFPSAMPLER_CALLOUT_DRIVER_TAG);
+   pCompletionData = (BASIC_PACKET_INJECTION_COMPLETION_DATA*)KrnlHlprCompletionPoolAcquire(g_pBPICompletionPool);
    HLPR_BAIL_ON_ALLOC_FAILURE(pCompletionData,
                               status);
 
-#pragma warning(pop)
-
    KeInitializeSpinLock(&(pCompletionData->spinLock));
 
    pCompletionData->performedInline = isInline;
@@ -1735,17 +1700,10 @@ NTSTATUS PerformBasicPacketInjectionAtOutboundNetwork(_In_ CLASSIFY_DATA** ppCla
 
 #endif /// DBG
 
-#pragma warning(push)
-#pragma warning(disable: 6014) /// pCompletionData will be freed in completionFn using BasicPacketInjectionCompletionDataDestroy
-
-   HLPR_NEW(pCompletionData,
-            BASIC_PACKET_INJECTION_COMPLETION_DATA,
-            WFPSAMPLER_CALLOUT_DRIVER_TAG);
+   pCompletionData = (BASIC_PACKET_INJECTION_COMPLETION_DATA*)KrnlHlprCompletionPoolAcquire(g_pBPICompletionPool);
    HLPR_BAIL_ON_ALLOC_FAILURE(pCompletionData,
                               status);
 
-#pragma warning(pop)
-
    KeInitializeSpinLock(&(pCompletionData->spinLock));
 
    pCompletionData->performedInline = isInline;
@@ -1915,17 +1873,10 @@ NTSTATUS PerformBasicPacketInjectionAtForward(_In_ CLASSIFY_DATA** ppClassifyDat
 
 #endif /// DBG
 
-#pragma warning(push)
-#pragma warning(disable: 6014) /// pCompletionData will be freed in completionFn using BasicPacketInjectionCompletionDataDestroy
-
-   HLPR_NEW(pCompletionData,
-            BASIC_PACKET_INJECTION_COMPLETION_DATA,
-            WFPSAMPLER_CALLOUT_DRIVER_TAG);
+   pCompletionData = (BASIC_PACKET_INJECTION_COMPLETION_DATA*)KrnlHlprCompletionPoolAcquire(g_pBPICompletionPool);
    HLPR_BAIL_ON_ALLOC_FAILURE(pCompletionData,
                               status);
 
-#pragma warning(pop)
-
    KeInitializeSpinLock(&(pCompletionData->spinLock));
 
    pCompletionData->performedInline = isInline;
@@ -2304,17 +2255,10 @@ NTSTATUS PerformBasicPacketInjectionAtInboundTransport(_In_ CLASSIFY_DATA** ppCl
 
 #endif /// DBG
 
-#pragma warning(push)
-#pragma warning(disable: 6014) /// pCompletionData will be freed in completionFn using BasicPacketInjectionCompletionDataDestroy
-
-   HLPR_NEW(pCompletionData,
-            BASIC_PACKET_INJECTION_COMPLETION_DATA,
-            WFPSAMPLER_CALLOUT_DRIVER_TAG);
+   pCompletionData = (BASIC_PACKET_INJECTION_COMPLETION_DATA*)KrnlHlprCompletionPoolAcquire(g_pBPICompletionPool);
    HLPR_BAIL_ON_ALLOC_FAILURE(pCompletionData,
                               status);
 
-#pragma warning(pop)
-
    KeInitializeSpinLock(&(pCompletionData->spinLock));
 
    pCompletionData->performedInline = isInline;
@@ -2851,11 +2795,9 @@ NTSTATUS PerformBasicPacketInjectionAtOutboundTransport(_In_ CLASSIFY_DATA** ppC
    FWPS_INCOMING_VALUES*                   pClassifyValues = (FWPS_INCOMING_VALUES*)(*ppClassifyData)->pClassifyValues;
    FWPS_INCOMING_METADATA_VALUES*          pMetadata       = (FWPS_INCOMING_METADATA_VALUES*)(*ppClassifyData)->pMetadataValues;
    UINT64                                  endpointHandle  = 0;
-   FWPS_TRANSPORT_SEND_PARAMS*             pSendParams     = 0;
    COMPARTMENT_ID                          compartmentID   = DEFAULT_COMPARTMENT_ID;
    NET_BUFFER_LIST*                        pNetBufferList  = 0;
    BASIC_PACKET_INJECTION_COMPLETION_DATA* pCompletionData = 0;
-   BYTE*                                   pRemoteAddress  = 0;
    FWP_VALUE*                              pAddressValue   = 0;
 
 #if DBG
@@ -2865,37 +2807,23 @@ NTSTATUS PerformBasicPacketInjectionAtOutboundTransport(_In_ CLASSIFY_DATA** ppC
 
 #endif /// DBG
 
-#pragma warning(push)
-#pragma warning(disable: 6014) /// pCompletionData & pSendParams will be freed in completionFn using BasicPacketInjectionCompletionDataDestroy
-
-   HLPR_NEW(pCompletionData,
-            BASIC_PACKET_INJECTION_COMPLETION_DATA,
-            WFPSAMPLER_CALLOUT_DRIVER_TAG);
+   pCompletionData = (BASIC_PACKET_INJECTION_COMPLETION_DATA*)KrnlHlprCompletionPoolAcquire(g_pBPICompletionPool);
    HLPR_BAIL_ON_ALLOC_FAILURE(pCompletionData,
                               status);
 
-   HLPR_NEW(pSendParams,
-            FWPS_TRANSPORT_SEND_PARAMS,
-            WFPSAMPLER_CALLOUT_DRIVER_TAG);
-   HLPR_BAIL_ON_ALLOC_FAILURE(pSendParams,
-                              status);
-
-#pragma warning(pop)
-
    KeInitializeSpinLock(&(pCompletionData->spinLock));
 
+   /// The send parameters and remote address are embedded in the pooled completion data.
    pCompletionData->performedInline = isInline;
    pCompletionData->pClassifyData   = *ppClassifyData;
    pCompletionData->pInjectionData  = *ppInjectionData;
-   pCompletionData->pSendParams     = pSendParams;
+   pCompletionData->pSendParams     = &(pCompletionData->sendParams);
 
    /// Responsibility for freeing this memory has been transferred to the pCompletionData
    *ppClassifyData = 0;
 
    *ppInjectionData = 0;
 
-   pSendParams = 0;
-
    if(FWPS_IS_METADATA_FIELD_PRESENT(pMetadata,
                                      FWPS_METADATA_FIELD_TRANSPORT_ENDPOINT_HANDLE))
       endpointHandle = pMetadata->transportEndpointHandle;
@@ -2912,32 +2840,13 @@ NTSTATUS PerformBasicPacketInjectionAtOutboundTransport(_In_ CLASSIFY_DATA** ppC
       {
          UINT32 tempAddress = htonl(pAddressValue->uint32);
 
-         HLPR_NEW_ARRAY(pRemoteAddress,
-                        BYTE,
-                        IPV4_ADDRESS_SIZE,
-                        WFPSAMPLER_CALLOUT_DRIVER_TAG);
-         HLPR_BAIL_ON_ALLOC_FAILURE(pRemoteAddress,
-                                    status);
-
-         RtlCopyMemory(pRemoteAddress,
+         RtlCopyMemory(pCompletionData->remoteAddress,
                        &tempAddress,
                        IPV4_ADDRESS_SIZE);
       }
       else
       {
-#pragma warning(push)
-#pragma warning(disable: 6014) /// pRemoteAddress will be freed in completionFn using BasicPacketInjectionCompletionDataDestroy
-
-         HLPR_NEW_ARRAY(pRemoteAddress,
-                        BYTE,
-                        IPV6_ADDRESS_SIZE,
-                        WFPSAMPLER_CALLOUT_DRIVER_TAG);
-         HLPR_BAIL_ON_ALLOC_FAILURE(pRemoteAddress,
-                                    status);
-
-#pragma warning(pop)
-
-         RtlCopyMemory(pRemoteAddress,
+         RtlCopyMemory(pCompletionData->remoteAddress,
                        pAddressValue->byteArray16->byteArray16,
                        IPV6_ADDRESS_SIZE);
 
@@ -2946,7 +2855,7 @@ NTSTATUS PerformBasicPacketInjectionAtOutboundTransport(_In_ CLASSIFY_DATA** ppC
             pCompletionData->pSendParams->remoteScopeId = pMetadata->remoteScopeId;
       }
 
-      pCompletionData->pSendParams->remoteAddress = pRemoteAddress;
+      pCompletionData->pSendParams->remoteAddress = pCompletionData->remoteAddress;
    }
 
    pCompletionData->pSendParams->controlData       = (WSACMSGHDR*)pCompletionData->pInjectionData->pControlData;
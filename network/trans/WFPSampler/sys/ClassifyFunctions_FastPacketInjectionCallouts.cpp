@@ -125,6 +125,7 @@ VOID NTAPI ClassifyFastPacketInjection(_In_ const FWPS_INCOMING_VALUES* pClassif
       HANDLE                      injectionContext      = 0;
       UINT32                      bytesRetreated        = 0;
       NET_BUFFER_LIST*            pClonedNetBufferList  = 0;
+      FAST_PACKET_INJECTION_COMPLETION_DATA* pCompletionData = 0;
       UINT32                      index                 = WFPSAMPLER_INDEX;
 
 #if(NTDDI_VERSION >= NTDDI_WIN8)
@@ -905,6 +906,10 @@ VOID NTAPI ClassifyFastPacketInjection(_In_ const FWPS_INCOMING_VALUES* pClassif
 
             HLPR_BAIL_ON_FAILURE(status);
 
+            pCompletionData = (FAST_PACKET_INJECTION_COMPLETION_DATA*)KrnlHlprCompletionPoolAcquire(g_pFPICompletionPool);
+            HLPR_BAIL_ON_ALLOC_FAILURE(pCompletionData,
+                                       status);
+
             if(injectionHandle == g_pIPv4InboundNetworkInjectionHandles[index] ||
                injectionHandle == g_pIPv6InboundNetworkInjectionHandles[index])
                status = FwpsInjectNetworkReceiveAsync(injectionHandle,
@@ -915,7 +920,7 @@ VOID NTAPI ClassifyFastPacketInjection(_In_ const FWPS_INCOMING_VALUES* pClassif
                                                       subInterfaceIndex,
                                                       pClonedNetBufferList,
                                                       CompleteFastPacketInjection,
-                                                      0);
+                                                      pCompletionData);
             else if(injectionHandle == g_pIPv4OutboundNetworkInjectionHandles[index] ||
                     injectionHandle == g_pIPv6OutboundNetworkInjectionHandles[index])
                status = FwpsInjectNetworkSendAsync(injectionHandle,
@@ -924,7 +929,7 @@ VOID NTAPI ClassifyFastPacketInjection(_In_ const FWPS_INCOMING_VALUES* pClassif
                                                    compartmentID,
                                                    pClonedNetBufferList,
                                                    CompleteFastPacketInjection,
-                                                   0);
+                                                   pCompletionData);
             else if(injectionHandle == g_pIPv4InboundForwardInjectionHandles[index] ||
                     injectionHandle == g_pIPv6InboundForwardInjectionHandles[index] ||
                     injectionHandle == g_pIPv4OutboundForwardInjectionHandles[index] ||
@@ -937,7 +942,7 @@ VOID NTAPI ClassifyFastPacketInjection(_In_ const FWPS_INCOMING_VALUES* pClassif
                                                interfaceIndex,
                                                pClonedNetBufferList,
                                                CompleteFastPacketInjection,
-                                               0);
+                                               pCompletionData);
             else if(injectionHandle == g_pIPv4InboundTransportInjectionHandles[index] ||
                     injectionHandle == g_pIPv6InboundTransportInjectionHandles[index])
                status = FwpsInjectTransportReceiveAsync(injectionHandle,
@@ -950,30 +955,16 @@ VOID NTAPI ClassifyFastPacketInjection(_In_ const FWPS_INCOMING_VALUES* pClassif
                                                         subInterfaceIndex,
                                                         pClonedNetBufferList,
                                                         CompleteFastPacketInjection,
-                                                        0);
+                                                        pCompletionData);
             else if(injectionHandle == g_pIPv4OutboundTransportInjectionHandles[index] ||
                     injectionHandle == g_pIPv6OutboundTransportInjectionHandles[index])
             {
-               FWPS_TRANSPORT_SEND_PARAMS* pSendParams = 0;
+               FWPS_TRANSPORT_SEND_PARAMS* pSendParams = &(pCompletionData->sendParams);
                UINT32                      addressSize = addressFamily == AF_INET ? IPV4_ADDRESS_SIZE : IPV6_ADDRESS_SIZE;
 
-#pragma warning(push)
-#pragma warning(disable: 6014) /// pSendParams will be freed in completionFn using FastPacketInjectionCompletionDataDestroy
-
-               HLPR_NEW(pSendParams,
-                        FWPS_TRANSPORT_SEND_PARAMS,
-                        WFPSAMPLER_CALLOUT_DRIVER_TAG);
-               HLPR_BAIL_ON_ALLOC_FAILURE_2(pSendParams,
-                                            status);
-
-               HLPR_NEW_ARRAY(pSendParams->remoteAddress,
-                              BYTE,
-                              addressSize,
-                              WFPSAMPLER_CALLOUT_DRIVER_TAG);
-               HLPR_BAIL_ON_ALLOC_FAILURE_2(pSendParams->remoteAddress,
-                                            status);
-
-#pragma warning(pop)
+               /// The send parameters and remote address live in the pooled completion data, so
+               /// they remain valid until CompleteFastPacketInjection recycles it.
+               pSendParams->remoteAddress = pCompletionData->remoteAddress;
 
                if(FWPS_IS_METADATA_FIELD_PRESENT(pMetadata,
                                                  FWPS_METADATA_FIELD_TRANSPORT_CONTROL_DATA))
@@ -1012,26 +1003,7 @@ VOID NTAPI ClassifyFastPacketInjection(_In_ const FWPS_INCOMING_VALUES* pClassif
                                                      compartmentID,
                                                      pClonedNetBufferList,
                                                      CompleteFastPacketInjection,
-                                                     pSendParams);
-
-               HLPR_BAIL_LABEL_2:
-
-               if(status != STATUS_SUCCESS)
-               {
-#pragma warning(push)
-#pragma warning(disable: 28924) /// pSendParams could be NULL if the ALLOC fails
-
-                  if(pSendParams)
-                  {
-                     HLPR_DELETE_ARRAY(pSendParams->remoteAddress,
-                                       WFPSAMPLER_CALLOUT_DRIVER_TAG);
-                  }
-
-                  HLPR_DELETE(pSendParams,
-                              WFPSAMPLER_CALLOUT_DRIVER_TAG);
-
-#pragma warning(pop)
-               }
+                                                     pCompletionData);
             }
 
 #if(NTDDI_VERSION >= NTDDI_WIN8)
@@ -1047,7 +1019,7 @@ VOID NTAPI ClassifyFastPacketInjection(_In_ const FWPS_INCOMING_VALUES* pClassif
                                                   ndisPort,
                                                   pClonedNetBufferList,
                                                   CompleteFastPacketInjection,
-                                                  0);
+                                                  pCompletionData);
             else if(injectionHandle == g_pIPv4OutboundMACInjectionHandles[index] ||
                     injectionHandle == g_pIPv6OutboundMACInjectionHandles[index] ||
                     injectionHandle == g_pOutboundMACInjectionHandles[index])
@@ -1059,7 +1031,7 @@ VOID NTAPI ClassifyFastPacketInjection(_In_ const FWPS_INCOMING_VALUES* pClassif
                                                ndisPort,
                                                pClonedNetBufferList,
                                                CompleteFastPacketInjection,
-                                               0);
+                                               pCompletionData);
             else if(injectionHandle == g_pIPv4IngressVSwitchEthernetInjectionHandles[index] ||
                     injectionHandle == g_pIPv6IngressVSwitchEthernetInjectionHandles[index] ||
                     injectionHandle == g_pIngressVSwitchEthernetInjectionHandles[index] ||
@@ -1075,7 +1047,7 @@ VOID NTAPI ClassifyFastPacketInjection(_In_ const FWPS_INCOMING_VALUES* pClassif
                                                               sourceNICIndex,
                                                               pClonedNetBufferList,
                                                               CompleteFastPacketInjection,
-                                                              0);
+                                                              pCompletionData);
 
 #endif ///(NTDDI_VERSION >= NTDDI_WIN8)
 
@@ -1087,6 +1059,10 @@ VOID NTAPI ClassifyFastPacketInjection(_In_ const FWPS_INCOMING_VALUES* pClassif
                   FwpsFreeCloneNetBufferList(pClonedNetBufferList,
                                              0);
 
+               if(pCompletionData)
+                  KrnlHlprCompletionPoolRelease(g_pFPICompletionPool,
+                                                pCompletionData);
+
                DbgPrintEx(DPFLTR_IHVNETWORK_ID,
                           DPFLTR_ERROR_LEVEL,
                           " !!!! ClassifyFastPacketInjection : FwpsInjectAsync() [status: %#x]\n",
@@ -1164,6 +1140,7 @@ VOID NTAPI ClassifyFastPacketInjection(_In_ const FWPS_INCOMING_VALUES* pClassif
       HANDLE                      injectionContext      = 0;
       UINT32                      bytesRetreated        = 0;
       NET_BUFFER_LIST*            pClonedNetBufferList  = 0;
+      FAST_PACKET_INJECTION_COMPLETION_DATA* pCompletionData = 0;
       UINT32                      index                 = WFPSAMPLER_INDEX;
 
       if(FWPS_IS_METADATA_FIELD_PRESENT(pMetadata,
@@ -1724,6 +1701,10 @@ VOID NTAPI ClassifyFastPacketInjection(_In_ const FWPS_INCOMING_VALUES* pClassif
 
             HLPR_BAIL_ON_FAILURE(status);
 
+            pCompletionData = (FAST_PACKET_INJECTION_COMPLETION_DATA*)KrnlHlprCompletionPoolAcquire(g_pFPICompletionPool);
+            HLPR_BAIL_ON_ALLOC_FAILURE(pCompletionData,
+                                       status);
+
             if(injectionHandle == g_pIPv4InboundNetworkInjectionHandles[index] ||
                injectionHandle == g_pIPv6InboundNetworkInjectionHandles[index])
                status = FwpsInjectNetworkReceiveAsync(injectionHandle,
@@ -1734,7 +1715,7 @@ VOID NTAPI ClassifyFastPacketInjection(_In_ const FWPS_INCOMING_VALUES* pClassif
                                                       subInterfaceIndex,
                                                       pClonedNetBufferList,
                                                       CompleteFastPacketInjection,
-                                                      0);
+                                                      pCompletionData);
             else if(injectionHandle == g_pIPv4OutboundNetworkInjectionHandles[index] ||
                     injectionHandle == g_pIPv6OutboundNetworkInjectionHandles[index])
                status = FwpsInjectNetworkSendAsync(injectionHandle,
@@ -1743,7 +1724,7 @@ VOID NTAPI ClassifyFastPacketInjection(_In_ const FWPS_INCOMING_VALUES* pClassif
                                                    compartmentID,
                                                    pClonedNetBufferList,
                                                    CompleteFastPacketInjection,
-                                                   0);
+                                                   pCompletionData);
             else if(injectionHandle == g_pIPv4InboundForwardInjectionHandles[index] ||
                     injectionHandle == g_pIPv6InboundForwardInjectionHandles[index] ||
                     injectionHandle == g_pIPv4OutboundForwardInjectionHandles[index] ||
@@ -1756,7 +1737,7 @@ VOID NTAPI ClassifyFastPacketInjection(_In_ const FWPS_INCOMING_VALUES* pClassif
                                                interfaceIndex,
                                                pClonedNetBufferList,
                                                CompleteFastPacketInjection,
-                                               0);
+                                               pCompletionData);
             else if(injectionHandle == g_pIPv4InboundTransportInjectionHandles[index] ||
                     injectionHandle == g_pIPv6InboundTransportInjectionHandles[index])
                status = FwpsInjectTransportReceiveAsync(injectionHandle,
@@ -1769,30 +1750,16 @@ VOID NTAPI ClassifyFastPacketInjection(_In_ const FWPS_INCOMING_VALUES* pClassif
                                                         subInterfaceIndex,
                                                         pClonedNetBufferList,
                                                         CompleteFastPacketInjection,
-                                                        0);
+                                                        pCompletionData);
             else if(injectionHandle == g_pIPv4OutboundTransportInjectionHandles[index] ||
                     injectionHandle == g_pIPv6OutboundTransportInjectionHandles[index])
             {
-               FWPS_TRANSPORT_SEND_PARAMS* pSendParams = 0;
+               FWPS_TRANSPORT_SEND_PARAMS* pSendParams = &(pCompletionData->sendParams);
                UINT32                      addressSize = addressFamily == AF_INET ? IPV4_ADDRESS_SIZE : IPV6_ADDRESS_SIZE;
 
-#pragma warning(push)
-#pragma warning(disable: 6014) /// pSendParams will be freed in completionFn using FastPacketInjectionCompletionDataDestroy
-
-               HLPR_NEW(pSendParams,
-                        FWPS_TRANSPORT_SEND_PARAMS,
-                        WFPSAMPLER_CALLOUT_DRIVER_TAG);
-               HLPR_BAIL_ON_ALLOC_FAILURE_2(pSendParams,
-                                            status);
-
-               HLPR_NEW_ARRAY(pSendParams->remoteAddress,
-                              BYTE,
-                              addressSize,
-                              WFPSAMPLER_CALLOUT_DRIVER_TAG);
-               HLPR_BAIL_ON_ALLOC_FAILURE_2(pSendParams->remoteAddress,
-                                            status);
-
-#pragma warning(pop)
+               /// The send parameters and remote address live in the pooled completion data, so
+               /// they remain valid until CompleteFastPacketInjection recycles it.
+               pSendParams->remoteAddress = pCompletionData->remoteAddress;
 
                if(FWPS_IS_METADATA_FIELD_PRESENT(pMetadata,
                                                  FWPS_METADATA_FIELD_TRANSPORT_CONTROL_DATA))
@@ -1831,26 +1798,7 @@ VOID NTAPI ClassifyFastPacketInjection(_In_ const FWPS_INCOMING_VALUES* pClassif
                                                      compartmentID,
                                                      pClonedNetBufferList,
                                                      CompleteFastPacketInjection,
-                                                     pSendParams);
-
-               HLPR_BAIL_LABEL_2:
-
-               if(status != STATUS_SUCCESS)
-               {
-#pragma warning(push)
-#pragma warning(disable: 28924) /// pSendParams could be NULL if the ALLOC fails
-
-                  if(pSendParams)
-                  {
-                     HLPR_DELETE_ARRAY(pSendParams->remoteAddress,
-                                       WFPSAMPLER_CALLOUT_DRIVER_TAG);
-                  }
-
-                  HLPR_DELETE(pSendParams,
-                              WFPSAMPLER_CALLOUT_DRIVER_TAG);
-
-#pragma warning(pop)
-               }
+                                                     pCompletionData);
             }
 
             HLPR_BAIL_LABEL:
@@ -1861,6 +1809,10 @@ VOID NTAPI ClassifyFastPacketInjection(_In_ const FWPS_INCOMING_VALUES* pClassif
                   FwpsFreeCloneNetBufferList(pClonedNetBufferList,
                                              0);
 
+               if(pCompletionData)
+                  KrnlHlprCompletionPoolRelease(g_pFPICompletionPool,
+                                                pCompletionData);
+
                DbgPrintEx(DPFLTR_IHVNETWORK_ID,
                           DPFLTR_ERROR_LEVEL,
                           " !!!! ClassifyFastPacketInjection : FwpsInjectAsync() [status: %#x]\n",
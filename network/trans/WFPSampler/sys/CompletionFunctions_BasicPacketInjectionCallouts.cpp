@@ -164,7 +164,7 @@ VOID BasicPacketInjectionCountersDecrement(_In_ HANDLE injectionHandle,
    MSDN_Ref:                                                                                    <br>
 */
 _At_(*ppCompletionData, _Pre_ _Notnull_)
-_At_(*ppCompletionData, _Post_ _Null_ __drv_freesMem(Pool))
+_At_(*ppCompletionData, _Post_ _Null_)
 _IRQL_requires_min_(PASSIVE_LEVEL)
 _IRQL_requires_max_(DISPATCH_LEVEL)
 _IRQL_requires_same_
@@ -210,20 +210,16 @@ VOID BasicPacketInjectionCompletionDataDestroy(_Inout_ BASIC_PACKET_INJECTION_CO
       if(pCompletionData->pInjectionData)
          KrnlHlprInjectionDataDestroy(&(pCompletionData->pInjectionData));
 
-      if(pCompletionData->pSendParams)
-      {
-         HLPR_DELETE_ARRAY(pCompletionData->pSendParams->remoteAddress,
-                           WFPSAMPLER_CALLOUT_DRIVER_TAG);
-
-         HLPR_DELETE(pCompletionData->pSendParams,
-                     WFPSAMPLER_CALLOUT_DRIVER_TAG);
-      }
+      /// pSendParams points into the completion data itself, so there is nothing to free.
+      pCompletionData->pSendParams = 0;
 
       KeReleaseSpinLock(&(pCompletionData->spinLock),
                         originalIRQL);
 
-      HLPR_DELETE(*ppCompletionData,
-                  WFPSAMPLER_CALLOUT_DRIVER_TAG);
+      KrnlHlprCompletionPoolRelease(g_pBPICompletionPool,
+                                    pCompletionData);
+
+      *ppCompletionData = 0;
    }
 
 #if DBG
@@ -23,6 +23,7 @@
 #ifndef COMPLETION_BASIC_PACKET_INJECTION_H
 #define COMPLETION_BASIC_PACKET_INJECTION_H
 
+/// Taken from g_pBPICompletionPool for every injection and recycled once its refCount drops.
 typedef struct BASIC_PACKET_INJECTION_COMPLETION_DATA_
 {
    KSPIN_LOCK                  spinLock;
@@ -30,9 +31,13 @@ typedef struct BASIC_PACKET_INJECTION_COMPLETION_DATA_
    BOOLEAN                     performedInline;
    CLASSIFY_DATA*              pClassifyData;
    INJECTION_DATA*             pInjectionData;
-   FWPS_TRANSPORT_SEND_PARAMS* pSendParams;
+   FWPS_TRANSPORT_SEND_PARAMS* pSendParams;                      /// 0 or &sendParams
+   FWPS_TRANSPORT_SEND_PARAMS  sendParams;
+   BYTE                        remoteAddress[IPV6_ADDRESS_SIZE];
 }BASIC_PACKET_INJECTION_COMPLETION_DATA, *PBASIC_PACKET_INJECTION_COMPLETION_DATA;
 
+extern COMPLETION_POOL* g_pBPICompletionPool;
+
 #if DBG
 
 extern INJECTION_COUNTERS g_bpiTotalCompletions;
@@ -43,7 +48,7 @@ VOID BasicPacketInjectionCountersDecrement(_In_ HANDLE injectionHandle,
 #endif /// DBG
 
 _At_(*ppCompletionData, _Pre_ _Notnull_)
-_At_(*ppCompletionData, _Post_ _Null_ __drv_freesMem(Pool))
+_At_(*ppCompletionData, _Post_ _Null_)
 _IRQL_requires_min_(PASSIVE_LEVEL)
 _IRQL_requires_max_(DISPATCH_LEVEL)
 _IRQL_requires_same_
@@ -43,7 +43,7 @@
 /**
  @completion_function="CompleteFastPacketInjection"
  
-   Purpose:                                                                                     <br>
+   Purpose:  Free the clone and recycle its completion data into g_pFPICompletionPool.          <br>
                                                                                                 <br>
    Notes:                                                                                       <br>
                                                                                                 <br>
@@ -59,21 +59,14 @@ VOID NTAPI CompleteFastPacketInjection(_In_ VOID* pContext,
 {
    UNREFERENCED_PARAMETER(dispatchLevel);
 
+   NT_ASSERT(pContext);
    NT_ASSERT(NT_SUCCESS(pNetBufferList->Status));
 
    FwpsFreeCloneNetBufferList(pNetBufferList,
                               0);
 
-   if(pContext)
-   {
-      FWPS_TRANSPORT_SEND_PARAMS* pSendParams = (FWPS_TRANSPORT_SEND_PARAMS*)pContext;
-
-      HLPR_DELETE_ARRAY(pSendParams->remoteAddress,
-                        WFPSAMPLER_CALLOUT_DRIVER_TAG);
-      
-      HLPR_DELETE(pSendParams,
-                  WFPSAMPLER_CALLOUT_DRIVER_TAG);
-   }
+   KrnlHlprCompletionPoolRelease(g_pFPICompletionPool,
+                                 pContext);
 
    return;
 }
@@ -23,6 +23,15 @@
 #ifndef COMPLETION_FAST_PACKET_INJECTION_H
 #define COMPLETION_FAST_PACKET_INJECTION_H
 
+/// Taken from g_pFPICompletionPool for every injected clone and recycled by the completionFn.
+typedef struct FAST_PACKET_INJECTION_COMPLETION_DATA_
+{
+   FWPS_TRANSPORT_SEND_PARAMS sendParams;
+   BYTE                       remoteAddress[IPV6_ADDRESS_SIZE];
+}FAST_PACKET_INJECTION_COMPLETION_DATA, *PFAST_PACKET_INJECTION_COMPLETION_DATA;
+
+extern COMPLETION_POOL* g_pFPICompletionPool;
+
 _IRQL_requires_min_(PASSIVE_LEVEL)
 _IRQL_requires_max_(DISPATCH_LEVEL)
 _IRQL_requires_same_
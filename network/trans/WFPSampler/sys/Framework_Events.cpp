@@ -161,9 +161,18 @@ VOID EventCleanupDeviceObject(_In_ WDFOBJECT deviceObject)
 
    UnregisterPowerStateChangeCallback(&g_deviceExtension);
 
+   if(g_pBPICompletionPool)
+      KrnlHlprCompletionPoolDestroy(&g_pBPICompletionPool);
+
+   if(g_pFPICompletionPool)
+      KrnlHlprCompletionPoolDestroy(&g_pFPICompletionPool);
+
    if(g_pNDISPoolData)
       KrnlHlprNDISPoolDataDestroy(&g_pNDISPoolData);
 
+   if(g_pCalloutStatistics)
+      KrnlHlprCalloutStatisticsDestroy(&g_pCalloutStatistics);
+
 #if DBG
    
    DbgPrintEx(DPFLTR_IHVNETWORK_ID,
@@ -180,9 +189,12 @@ VOID EventCleanupDeviceObject(_In_ WDFOBJECT deviceObject)
  
    Purpose:  Callback function responding to IO Control Events.                                 <br>
                                                                                                 <br>
-   Notes:                                                                                       <br>
+   Notes:    Services IOCTL_WFPSAMPLER_QUERY_CALLOUT_STATISTICS and
+             IOCTL_WFPSAMPLER_RESET_CALLOUT_STATISTICS.                                         <br>
                                                                                                 <br>
    MSDN_Ref: HTTP://MSDN.Microsoft.com/En-US/Library/Windows/Hardware/FF541758.aspx             <br>
+             HTTP://MSDN.Microsoft.com/En-US/Library/Windows/Hardware/FF550014.aspx             <br>
+             HTTP://MSDN.Microsoft.com/En-US/Library/Windows/Hardware/FF549948.aspx             <br>
 */
 _IRQL_requires_min_(PASSIVE_LEVEL)
 _IRQL_requires_max_(DISPATCH_LEVEL)
@@ -203,16 +215,56 @@ VOID EventIODeviceControl(_In_ WDFQUEUE wdfQueue,
 #endif /// DBG
    
    UNREFERENCED_PARAMETER(wdfQueue);
-   UNREFERENCED_PARAMETER(wdfRequest);
-   UNREFERENCED_PARAMETER(outputBufferLength);
    UNREFERENCED_PARAMETER(inputBufferLength);
-   UNREFERENCED_PARAMETER(ioControlCode);
+
+   NTSTATUS status       = STATUS_INVALID_DEVICE_REQUEST;
+   size_t   bytesWritten = 0;
+
+   switch(ioControlCode)
+   {
+      case IOCTL_WFPSAMPLER_QUERY_CALLOUT_STATISTICS:
+      {
+         VOID* pBuffer = 0;
+
+         status = WdfRequestRetrieveOutputBuffer(wdfRequest,
+                                                 sizeof(CALLOUT_STATISTICS_HEADER),
+                                                 &pBuffer,
+                                                 0);
+         if(status != STATUS_SUCCESS)
+         {
+            DbgPrintEx(DPFLTR_IHVNETWORK_ID,
+                       DPFLTR_ERROR_LEVEL,
+                       " !!!! EventIODeviceControl : WdfRequestRetrieveOutputBuffer() [status: %#x]\n",
+                       status);
+
+            break;
+         }
+
+         status = KrnlHlprCalloutStatisticsQuery(g_pCalloutStatistics,
+                                                 pBuffer,
+                                                 outputBufferLength,
+                                                 &bytesWritten);
+
+         break;
+      }
+      case IOCTL_WFPSAMPLER_RESET_CALLOUT_STATISTICS:
+      {
+         status = KrnlHlprCalloutStatisticsReset(g_pCalloutStatistics);
+
+         break;
+      }
+   }
+
+   WdfRequestCompleteWithInformation(wdfRequest,
+                                     status,
+                                     bytesWritten);
 
 #if DBG
    
    DbgPrintEx(DPFLTR_IHVNETWORK_ID,
               DPFLTR_INFO_LEVEL,
-              " <--- EventIODeviceControl()\n");
+              " <--- EventIODeviceControl() [status: %#x]\n",
+              status);
 
 #endif /// DBG
    
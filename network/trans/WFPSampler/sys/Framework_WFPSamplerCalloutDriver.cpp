@@ -34,6 +34,9 @@ extern "C"
 
 PDEVICE_OBJECT         g_pWDMDevice            = 0;
 NDIS_POOL_DATA*        g_pNDISPoolData         = 0;
+COMPLETION_POOL*       g_pFPICompletionPool    = 0;
+COMPLETION_POOL*       g_pBPICompletionPool    = 0;
+CALLOUT_STATISTICS*    g_pCalloutStatistics    = 0;
 BOOLEAN                g_calloutsRegistered    = FALSE;
 HANDLE                 g_bfeSubscriptionHandle = 0;
 SERIALIZATION_LIST     g_bsiSerializationList  = {0};
@@ -135,6 +138,82 @@ NTSTATUS PrvFwpmBfeStateSubscribeChanges()
    return status;
 }
 
+/**
+ @private_function="PrvCalloutStatisticsEnable"
+
+   Purpose:  Allocate the classify instrumentation if the CalloutStatistics value under the
+             service's Parameters key is non-zero.                                              <br>
+                                                                                                <br>
+   Notes:    Instrumentation is off by default, and failing to enable it does not prevent the
+             driver from loading.                                                               <br>
+                                                                                                <br>
+   MSDN_Ref: HTTP://MSDN.Microsoft.com/En-US/Library/Windows/Hardware/FF547202.aspx             <br>
+             HTTP://MSDN.Microsoft.com/En-US/Library/Windows/Hardware/FF549925.aspx             <br>
+*/
+_IRQL_requires_(PASSIVE_LEVEL)
+_IRQL_requires_same_
+VOID PrvCalloutStatisticsEnable(_In_ WDFDRIVER wdfDriver)
+{
+#if DBG
+
+   DbgPrintEx(DPFLTR_IHVNETWORK_ID,
+              DPFLTR_INFO_LEVEL,
+              " ---> PrvCalloutStatisticsEnable()\n");
+
+#endif /// DBG
+
+   NTSTATUS status    = STATUS_SUCCESS;
+   WDFKEY   wdfKey    = 0;
+   ULONG    isEnabled = 0;
+
+   DECLARE_CONST_UNICODE_STRING(valueName,
+                                WFPSAMPLER_CALLOUT_STATISTICS_VALUE_NAME);
+
+   status = WdfDriverOpenParametersRegistryKey(wdfDriver,
+                                               KEY_READ,
+                                               WDF_NO_OBJECT_ATTRIBUTES,
+                                               &wdfKey);
+   HLPR_BAIL_ON_FAILURE(status);
+
+   status = WdfRegistryQueryULong(wdfKey,
+                                  &valueName,
+                                  &isEnabled);
+   HLPR_BAIL_ON_FAILURE(status);
+
+   if(isEnabled)
+   {
+
+#pragma warning(push)
+#pragma warning(disable: 6388) /// g_pCalloutStatistics will be 0
+
+      status = KrnlHlprCalloutStatisticsCreate(&g_pCalloutStatistics);
+      if(status != STATUS_SUCCESS)
+         DbgPrintEx(DPFLTR_IHVNETWORK_ID,
+                    DPFLTR_ERROR_LEVEL,
+                    " !!!! PrvCalloutStatisticsEnable : KrnlHlprCalloutStatisticsCreate() [status: %#x]\n",
+                    status);
+
+#pragma warning(pop)
+
+   }
+
+   HLPR_BAIL_LABEL:
+
+   if(wdfKey)
+      WdfRegistryClose(wdfKey);
+
+#if DBG
+
+   DbgPrintEx(DPFLTR_IHVNETWORK_ID,
+              DPFLTR_INFO_LEVEL,
+              " <--- PrvCalloutStatisticsEnable() [status: %#x]\n",
+              status);
+
+#endif /// DBG
+
+   return;
+}
+
 /**
  @private_function="PrvWFPSamplerDeviceDataPopulate"
  
@@ -366,13 +445,20 @@ NTSTATUS PrvDriverDeviceAdd(_In_ WDFDRIVER* pWDFDriver)
    NTSTATUS              status         = STATUS_SUCCESS;
    PWDFDEVICE_INIT       pWDFDeviceInit = 0;
    WDF_OBJECT_ATTRIBUTES attributes     = {0};
+   WDF_IO_QUEUE_CONFIG   queueConfig;
+
+   DECLARE_CONST_UNICODE_STRING(deviceName,
+                                WFPSAMPLER_DEVICE_NAME);
+   DECLARE_CONST_UNICODE_STRING(symbolicLinkName,
+                                WFPSAMPLER_SYMBOLIC_LINK_NAME);
 
    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
 
    attributes.EvtCleanupCallback = EventCleanupDeviceObject;
 
+   /// Administrators may open the device to query the classify instrumentation
    pWDFDeviceInit = WdfControlDeviceInitAllocate(*pWDFDriver,
-                                                 &SDDL_DEVOBJ_KERNEL_ONLY);
+                                                 &SDDL_DEVOBJ_SYS_ALL_ADM_ALL);
    if(pWDFDeviceInit == 0)
    {
       status = STATUS_UNSUCCESSFUL;
@@ -388,6 +474,18 @@ NTSTATUS PrvDriverDeviceAdd(_In_ WDFDRIVER* pWDFDriver)
    WdfDeviceInitSetDeviceType(pWDFDeviceInit,
                               FILE_DEVICE_NETWORK);
 
+   status = WdfDeviceInitAssignName(pWDFDeviceInit,
+                                    &deviceName);
+   if(status != STATUS_SUCCESS)
+   {
+      DbgPrintEx(DPFLTR_IHVNETWORK_ID,
+                 DPFLTR_ERROR_LEVEL,
+                 " !!!! PrvDriverDeviceAdd : WdfDeviceInitAssignName() [status: %#x]\n",
+                 status);
+
+      HLPR_BAIL;
+   }
+
    status = WdfDeviceCreate(&pWDFDeviceInit,
                             &attributes,
                             &g_WDFDevice);
@@ -405,6 +503,37 @@ NTSTATUS PrvDriverDeviceAdd(_In_ WDFDRIVER* pWDFDriver)
    HLPR_BAIL_ON_NULL_POINTER_WITH_STATUS(g_pWDMDevice,
                                          status);
 
+   status = WdfDeviceCreateSymbolicLink(g_WDFDevice,
+                                        &symbolicLinkName);
+   if(status != STATUS_SUCCESS)
+   {
+      DbgPrintEx(DPFLTR_IHVNETWORK_ID,
+                 DPFLTR_ERROR_LEVEL,
+                 " !!!! PrvDriverDeviceAdd : WdfDeviceCreateSymbolicLink() [status: %#x]\n",
+                 status);
+
+      HLPR_BAIL;
+   }
+
+   WDF_IO_QUEUE_CONFIG_INIT_DEFAULT_QUEUE(&queueConfig,
+                                          WdfIoQueueDispatchParallel);
+
+   queueConfig.EvtIoDeviceControl = EventIODeviceControl;
+
+   status = WdfIoQueueCreate(g_WDFDevice,
+                             &queueConfig,
+                             WDF_NO_OBJECT_ATTRIBUTES,
+                             0);
+   if(status != STATUS_SUCCESS)
+   {
+      DbgPrintEx(DPFLTR_IHVNETWORK_ID,
+                 DPFLTR_ERROR_LEVEL,
+                 " !!!! PrvDriverDeviceAdd : WdfIoQueueCreate() [status: %#x]\n",
+                 status);
+
+      HLPR_BAIL;
+   }
+
    status = RegisterPowerStateChangeCallback(&g_deviceExtension);
    HLPR_BAIL_ON_FAILURE(status);
 
@@ -414,6 +543,20 @@ NTSTATUS PrvDriverDeviceAdd(_In_ WDFDRIVER* pWDFDriver)
    status = KrnlHlprNDISPoolDataCreate(&g_pNDISPoolData);
    HLPR_BAIL_ON_FAILURE(status);
 
+#pragma warning(pop)
+
+#pragma warning(push)
+#pragma warning(disable: 6388) /// g_pFPICompletionPool & g_pBPICompletionPool will be 0
+
+   /// Pre-allocate the per-processor completion contexts used by the packet injection callouts
+   status = KrnlHlprCompletionPoolCreate(&g_pFPICompletionPool,
+                                         sizeof(FAST_PACKET_INJECTION_COMPLETION_DATA));
+   HLPR_BAIL_ON_FAILURE(status);
+
+   status = KrnlHlprCompletionPoolCreate(&g_pBPICompletionPool,
+                                         sizeof(BASIC_PACKET_INJECTION_COMPLETION_DATA));
+   HLPR_BAIL_ON_FAILURE(status);
+
 #pragma warning(pop)
 
    PrvFwpmBfeStateSubscribeChanges();
@@ -426,6 +569,8 @@ NTSTATUS PrvDriverDeviceAdd(_In_ WDFDRIVER* pWDFDriver)
    status = PrvBasicStreamInjectionSerializationListInitialization();
    HLPR_BAIL_ON_FAILURE(status);
 
+   /// Must precede callout registration so the classifyFns can be wrapped
+   PrvCalloutStatisticsEnable(*pWDFDriver);
 
    status = PrvWFPSamplerFwpObjectsAddGlobal(&g_WFPSamplerDeviceData);
    HLPR_BAIL_ON_FAILURE(status);
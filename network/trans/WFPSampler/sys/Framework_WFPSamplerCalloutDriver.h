@@ -43,14 +43,16 @@ extern "C"
 #pragma warning(pop)
 }
 
-#include "Identifiers.h"                     /// ..\Inc
-#include "ProviderContexts.h"                /// ..\Inc
-#include "HelperFunctions_Include.h"         /// ..\SysLib
-#include "HelperFunctions_ExposedCallouts.h" /// .
-#include "ClassifyFunctions_Include.h"       /// .
-#include "CompletionFunctions_Include.h"     /// .
-#include "NotifyFunctions_Include.h"         /// .
-#include "SubscriptionFunctions_Include.h"   /// .
+#include "Identifiers.h"                       /// ..\Inc
+#include "ProviderContexts.h"                  /// ..\Inc
+#include "CalloutStatistics.h"                 /// ..\Inc
+#include "HelperFunctions_Include.h"           /// ..\SysLib
+#include "HelperFunctions_ExposedCallouts.h"   /// .
+#include "ClassifyFunctions_Include.h"         /// .
+#include "CompletionFunctions_Include.h"       /// .
+#include "NotifyFunctions_Include.h"           /// .
+#include "SubscriptionFunctions_Include.h"     /// .
+#include "HelperFunctions_CalloutStatistics.h" /// .
 
 #define WFPSAMPLER_CALLOUT_DRIVER_TAG (UINT32)'DCSW'
 
@@ -0,0 +1,530 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//   Copyright (c) 2014 Microsoft Corporation.  All Rights Reserved.
+//
+//   Module Name:
+//      HelperFunctions_CalloutStatistics.cpp
+//
+//   Abstract:
+//      This module contains kernel helper functions that time every classifyFn and keep
+//         per-processor hit and latency counters for each callout family.
+//
+//   Naming Convention:
+//
+//      <Scope><Object><Action>
+//
+//      i.e.
+//
+//       <Scope>
+//          {
+//                                 - Function is likely visible to other modules.
+//            Prv                  - Function is private to this module.
+//          }
+//       <Object>
+//          {
+//            KrnlHlprCalloutStatistics - Function pertains to the classify instrumentation.
+//            CalloutStatistics         - Function pertains to the classify instrumentation.
+//          }
+//       <Action>
+//          {
+//            Classify              - Function wraps a classifyFn.
+//            Create                - Function allocates and initializes the counters.
+//            Destroy               - Function frees the counters.
+//            Instrument            - Function swaps a callout's classifyFn for its wrapper.
+//            Query                 - Function copies the counters to a caller's buffer.
+//            Record                - Function accounts for a single classify.
+//            Reset                 - Function zeroes the counters.
+//          }
+//
+//   Private Functions:
+//      PrvCalloutStatisticsClassify*(),
+//      PrvCalloutStatisticsRecord(),
+//
+//   Public Functions:
+//      KrnlHlprCalloutStatisticsCreate(),
+//      KrnlHlprCalloutStatisticsDestroy(),
+//      KrnlHlprCalloutStatisticsInstrument(),
+//      KrnlHlprCalloutStatisticsQuery(),
+//      KrnlHlprCalloutStatisticsReset(),
+//
+//   Author:
+//      Dusty Harper      (DHarper)
+//
+//   Revision History:
+//
+//      [ Month ][Day] [Year] - [Revision]-[ Comments ]
+//      May       01,   2010  -     1.0   -  Creation
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "Framework_WFPSamplerCalloutDriver.h"   /// .
+#include "HelperFunctions_CalloutStatistics.tmh" /// $(OBJ_PATH)\$(O)\
+
+typedef struct CALLOUT_STATISTICS_CLASSIFY_
+{
+   FWPS_CALLOUT_CLASSIFY_FN pClassifyFn;
+   FWPS_CALLOUT_CLASSIFY_FN pInstrumentedClassifyFn;
+}CALLOUT_STATISTICS_CLASSIFY, *PCALLOUT_STATISTICS_CLASSIFY;
+
+/**
+ @private_function="PrvCalloutStatisticsRecord"
+
+   Purpose:  Account for a single classify against the current processor's counters.           <br>
+                                                                                                <br>
+   Notes:    The classify may have been preempted onto another processor at PASSIVE_LEVEL, so
+             the counters are still updated with interlocked operations.                        <br>
+                                                                                                <br>
+   MSDN_Ref: HTTP://MSDN.Microsoft.com/En-US/Library/Windows/Hardware/FF552068.aspx             <br>
+*/
+_IRQL_requires_min_(PASSIVE_LEVEL)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_IRQL_requires_same_
+inline VOID PrvCalloutStatisticsRecord(_In_ CALLOUT_STATISTICS_ID calloutId,
+                                       _In_ UINT64 startCycles,
+                                       _In_ const FWPS_CLASSIFY_OUT* pClassifyOut)
+{
+   CALLOUT_STATISTICS* pStatistics = g_pCalloutStatistics;
+
+   if(pStatistics)
+   {
+      UINT64                       cycles         = ReadTimeStampCounter() - startCycles;
+      UINT32                       processorIndex = KeGetCurrentProcessorNumberEx(0) % pStatistics->processorCount;
+      UINT32                       bucket         = 0;
+      CALLOUT_STATISTICS_COUNTERS* pCounters      = &(pStatistics->pProcessors[processorIndex].pCounters[calloutId]);
+
+      if(cycles)
+      {
+         bucket = (UINT32)RtlFindMostSignificantBit((ULONGLONG)cycles);
+
+         if(bucket >= CALLOUT_STATISTICS_HISTOGRAM_BUCKETS)
+            bucket = CALLOUT_STATISTICS_HISTOGRAM_BUCKETS - 1;
+      }
+
+      InterlockedIncrement64((LONG64*)&(pCounters->invocations));
+
+      InterlockedAdd64((LONG64*)&(pCounters->cycles),
+                       (LONG64)cycles);
+
+      InterlockedIncrement64((LONG64*)&(pCounters->pHistogram[bucket]));
+
+      if(pClassifyOut->flags & FWPS_CLASSIFY_OUT_FLAG_ABSORB)
+         InterlockedIncrement64((LONG64*)&(pCounters->pends));
+   }
+
+   return;
+}
+
+/// Each wrapper times the classifyFn it is named for and records the result under calloutId.
+
+#if(NTDDI_VERSION >= NTDDI_WIN7)
+
+#define CALLOUT_STATISTICS_CLASSIFY_DEFINE(classifyFn, calloutId)                                 \
+   _IRQL_requires_min_(PASSIVE_LEVEL)                                                             \
+   _IRQL_requires_max_(DISPATCH_LEVEL)                                                            \
+   _IRQL_requires_same_                                                                           \
+   VOID NTAPI PrvCalloutStatistics##classifyFn(_In_ const FWPS_INCOMING_VALUES* pClassifyValues,  \
+                                               _In_ const FWPS_INCOMING_METADATA_VALUES* pMetadata,\
+                                               _Inout_opt_ VOID* pLayerData,                      \
+                                               _In_opt_ const VOID* pClassifyContext,             \
+                                               _In_ const FWPS_FILTER* pFilter,                   \
+                                               _In_ UINT64 flowContext,                           \
+                                               _Inout_ FWPS_CLASSIFY_OUT* pClassifyOut)           \
+   {                                                                                              \
+      UINT64 startCycles = ReadTimeStampCounter();                                                \
+                                                                                                  \
+      classifyFn(pClassifyValues,                                                                 \
+                 pMetadata,                                                                       \
+                 pLayerData,                                                                      \
+                 pClassifyContext,                                                                \
+                 pFilter,                                                                         \
+                 flowContext,                                                                     \
+                 pClassifyOut);                                                                   \
+                                                                                                  \
+      PrvCalloutStatisticsRecord(calloutId,                                                       \
+                                 startCycles,                                                     \
+                                 pClassifyOut);                                                   \
+                                                                                                  \
+      return;                                                                                     \
+   }
+
+#else
+
+#define CALLOUT_STATISTICS_CLASSIFY_DEFINE(classifyFn, calloutId)                                 \
+   _IRQL_requires_min_(PASSIVE_LEVEL)                                                             \
+   _IRQL_requires_max_(DISPATCH_LEVEL)                                                            \
+   _IRQL_requires_same_                                                                           \
+   VOID NTAPI PrvCalloutStatistics##classifyFn(_In_ const FWPS_INCOMING_VALUES* pClassifyValues,  \
+                                               _In_ const FWPS_INCOMING_METADATA_VALUES* pMetadata,\
+                                               _Inout_opt_ VOID* pLayerData,                      \
+                                               _In_ const FWPS_FILTER* pFilter,                   \
+                                               _In_ UINT64 flowContext,                           \
+                                               _Inout_ FWPS_CLASSIFY_OUT* pClassifyOut)           \
+   {                                                                                              \
+      UINT64 startCycles = ReadTimeStampCounter();                                                \
+                                                                                                  \
+      classifyFn(pClassifyValues,                                                                 \
+                 pMetadata,                                                                       \
+                 pLayerData,                                                                      \
+                 pFilter,                                                                         \
+                 flowContext,                                                                     \
+                 pClassifyOut);                                                                   \
+                                                                                                  \
+      PrvCalloutStatisticsRecord(calloutId,                                                       \
+                                 startCycles,                                                     \
+                                 pClassifyOut);                                                   \
+                                                                                                  \
+      return;                                                                                     \
+   }
+
+#endif /// (NTDDI_VERSION >= NTDDI_WIN7)
+
+CALLOUT_STATISTICS_CLASSIFY_DEFINE(ClassifyAdvancedPacketInjection, CALLOUT_STATISTICS_ADVANCED_PACKET_INJECTION)
+CALLOUT_STATISTICS_CLASSIFY_DEFINE(ClassifyBasicActionBlock,        CALLOUT_STATISTICS_BASIC_ACTION_BLOCK)
+CALLOUT_STATISTICS_CLASSIFY_DEFINE(ClassifyBasicActionContinue,     CALLOUT_STATISTICS_BASIC_ACTION_CONTINUE)
+CALLOUT_STATISTICS_CLASSIFY_DEFINE(ClassifyBasicActionPermit,       CALLOUT_STATISTICS_BASIC_ACTION_PERMIT)
+CALLOUT_STATISTICS_CLASSIFY_DEFINE(ClassifyBasicActionRandom,       CALLOUT_STATISTICS_BASIC_ACTION_RANDOM)
+CALLOUT_STATISTICS_CLASSIFY_DEFINE(ClassifyBasicPacketExamination,  CALLOUT_STATISTICS_BASIC_PACKET_EXAMINATION)
+CALLOUT_STATISTICS_CLASSIFY_DEFINE(ClassifyBasicPacketInjection,    CALLOUT_STATISTICS_BASIC_PACKET_INJECTION)
+CALLOUT_STATISTICS_CLASSIFY_DEFINE(ClassifyBasicPacketModification, CALLOUT_STATISTICS_BASIC_PACKET_MODIFICATION)
+CALLOUT_STATISTICS_CLASSIFY_DEFINE(ClassifyBasicStreamInjection,    CALLOUT_STATISTICS_BASIC_STREAM_INJECTION)
+CALLOUT_STATISTICS_CLASSIFY_DEFINE(ClassifyFastPacketInjection,     CALLOUT_STATISTICS_FAST_PACKET_INJECTION)
+CALLOUT_STATISTICS_CLASSIFY_DEFINE(ClassifyFastStreamInjection,     CALLOUT_STATISTICS_FAST_STREAM_INJECTION)
+CALLOUT_STATISTICS_CLASSIFY_DEFINE(ClassifyFlowAssociation,         CALLOUT_STATISTICS_FLOW_ASSOCIATION)
+CALLOUT_STATISTICS_CLASSIFY_DEFINE(ClassifyPendAuthorization,       CALLOUT_STATISTICS_PEND_AUTHORIZATION)
+
+#if(NTDDI_VERSION >= NTDDI_WIN7)
+
+CALLOUT_STATISTICS_CLASSIFY_DEFINE(ClassifyPendEndpointClosure,     CALLOUT_STATISTICS_PEND_ENDPOINT_CLOSURE)
+
+#endif /// (NTDDI_VERSION >= NTDDI_WIN7)
+
+CALLOUT_STATISTICS_CLASSIFY_DEFINE(ClassifyProxyByInjection,        CALLOUT_STATISTICS_PROXY_BY_INJECTION)
+CALLOUT_STATISTICS_CLASSIFY_DEFINE(ClassifyProxyByALERedirect,      CALLOUT_STATISTICS_PROXY_BY_ALE_REDIRECT)
+
+/// Indexed by CALLOUT_STATISTICS_ID
+static const CALLOUT_STATISTICS_CLASSIFY pCalloutStatisticsClassifyFns[CALLOUT_STATISTICS_MAX] =
+{
+   {ClassifyAdvancedPacketInjection, PrvCalloutStatisticsClassifyAdvancedPacketInjection},
+   {ClassifyBasicActionBlock,        PrvCalloutStatisticsClassifyBasicActionBlock},
+   {ClassifyBasicActionContinue,     PrvCalloutStatisticsClassifyBasicActionContinue},
+   {ClassifyBasicActionPermit,       PrvCalloutStatisticsClassifyBasicActionPermit},
+   {ClassifyBasicActionRandom,       PrvCalloutStatisticsClassifyBasicActionRandom},
+   {ClassifyBasicPacketExamination,  PrvCalloutStatisticsClassifyBasicPacketExamination},
+   {ClassifyBasicPacketInjection,    PrvCalloutStatisticsClassifyBasicPacketInjection},
+   {ClassifyBasicPacketModification, PrvCalloutStatisticsClassifyBasicPacketModification},
+   {ClassifyBasicStreamInjection,    PrvCalloutStatisticsClassifyBasicStreamInjection},
+   {ClassifyFastPacketInjection,     PrvCalloutStatisticsClassifyFastPacketInjection},
+   {ClassifyFastStreamInjection,     PrvCalloutStatisticsClassifyFastStreamInjection},
+   {ClassifyFlowAssociation,         PrvCalloutStatisticsClassifyFlowAssociation},
+   {ClassifyPendAuthorization,       PrvCalloutStatisticsClassifyPendAuthorization},
+
+#if(NTDDI_VERSION >= NTDDI_WIN7)
+
+   {ClassifyPendEndpointClosure,     PrvCalloutStatisticsClassifyPendEndpointClosure},
+
+#else
+
+   {0,                               0},
+
+#endif /// (NTDDI_VERSION >= NTDDI_WIN7)
+
+   {ClassifyProxyByInjection,        PrvCalloutStatisticsClassifyProxyByInjection},
+   {ClassifyProxyByALERedirect,      PrvCalloutStatisticsClassifyProxyByALERedirect},
+};
+
+/**
+ @kernel_helper_function="KrnlHlprCalloutStatisticsInstrument"
+
+   Purpose:  Replace the callout's classifyFn with the wrapper that times it.                   <br>
+                                                                                                <br>
+   Notes:    Must be called before FwpsCalloutRegister.  Does nothing unless the
+             instrumentation was enabled when the driver loaded.                                <br>
+                                                                                                <br>
+   MSDN_Ref: HTTP://MSDN.Microsoft.com/En-US/Library/Windows/Hardware/FF544019.aspx             <br>
+*/
+_IRQL_requires_(PASSIVE_LEVEL)
+_IRQL_requires_same_
+VOID KrnlHlprCalloutStatisticsInstrument(_Inout_ FWPS_CALLOUT* pCallout)
+{
+   NT_ASSERT(pCallout);
+
+   if(g_pCalloutStatistics &&
+      pCallout->classifyFn)
+   {
+      for(UINT32 calloutId = 0;
+          calloutId < CALLOUT_STATISTICS_MAX;
+          calloutId++)
+      {
+         if(pCallout->classifyFn == pCalloutStatisticsClassifyFns[calloutId].pClassifyFn)
+         {
+            pCallout->classifyFn = pCalloutStatisticsClassifyFns[calloutId].pInstrumentedClassifyFn;
+
+            break;
+         }
+      }
+   }
+
+   return;
+}
+
+/**
+ @kernel_helper_function="KrnlHlprCalloutStatisticsQuery"
+
+   Purpose:  Copy a CALLOUT_STATISTICS_HEADER followed by every processor's counters into the
+             caller's buffer.                                                                   <br>
+                                                                                                <br>
+   Notes:    If the buffer only holds the header, the header is filled in with the size needed
+             and STATUS_BUFFER_OVERFLOW is returned.                                            <br>
+                                                                                                <br>
+             Counters are read without synchronization, so a snapshot taken under load may be
+             off by the classifies in flight.                                                   <br>
+                                                                                                <br>
+   MSDN_Ref:                                                                                    <br>
+*/
+_IRQL_requires_min_(PASSIVE_LEVEL)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_IRQL_requires_same_
+_Check_return_
+_Success_(return == STATUS_SUCCESS || return == STATUS_BUFFER_OVERFLOW)
+NTSTATUS KrnlHlprCalloutStatisticsQuery(_In_opt_ const CALLOUT_STATISTICS* pStatistics,
+                                        _Out_writes_bytes_to_(bufferSize, *pBytesWritten) VOID* pBuffer,
+                                        _In_ size_t bufferSize,
+                                        _Out_ size_t* pBytesWritten)
+{
+#if DBG
+
+   DbgPrintEx(DPFLTR_IHVNETWORK_ID,
+              DPFLTR_INFO_LEVEL,
+              " ---> KrnlHlprCalloutStatisticsQuery()\n");
+
+#endif /// DBG
+
+   NT_ASSERT(pBuffer);
+   NT_ASSERT(pBytesWritten);
+
+   NTSTATUS                   status        = STATUS_SUCCESS;
+   CALLOUT_STATISTICS_HEADER* pHeader       = (CALLOUT_STATISTICS_HEADER*)pBuffer;
+   size_t                     processorSize = sizeof(CALLOUT_STATISTICS_COUNTERS) * CALLOUT_STATISTICS_MAX;
+   size_t                     totalSize     = 0;
+
+   *pBytesWritten = 0;
+
+   /// Instrumentation was not enabled when the driver loaded
+   if(pStatistics == 0)
+   {
+      status = STATUS_NOT_SUPPORTED;
+
+      HLPR_BAIL;
+   }
+
+   if(bufferSize < sizeof(CALLOUT_STATISTICS_HEADER))
+   {
+      status = STATUS_BUFFER_TOO_SMALL;
+
+      HLPR_BAIL;
+   }
+
+   totalSize = sizeof(CALLOUT_STATISTICS_HEADER) + (processorSize * pStatistics->processorCount);
+
+   pHeader->size             = (UINT32)totalSize;
+   pHeader->processorCount   = pStatistics->processorCount;
+   pHeader->calloutCount     = CALLOUT_STATISTICS_MAX;
+   pHeader->histogramBuckets = CALLOUT_STATISTICS_HISTOGRAM_BUCKETS;
+
+   *pBytesWritten = sizeof(CALLOUT_STATISTICS_HEADER);
+
+   if(bufferSize < totalSize)
+   {
+      status = STATUS_BUFFER_OVERFLOW;
+
+      HLPR_BAIL;
+   }
+
+   for(UINT32 processorIndex = 0;
+       processorIndex < pStatistics->processorCount;
+       processorIndex++)
+   {
+      RtlCopyMemory((BYTE*)pBuffer + *pBytesWritten,
+                    pStatistics->pProcessors[processorIndex].pCounters,
+                    processorSize);
+
+      *pBytesWritten += processorSize;
+   }
+
+   HLPR_BAIL_LABEL:
+
+#if DBG
+
+   DbgPrintEx(DPFLTR_IHVNETWORK_ID,
+              DPFLTR_INFO_LEVEL,
+              " <--- KrnlHlprCalloutStatisticsQuery() [status: %#x]\n",
+              status);
+
+#endif /// DBG
+
+   return status;
+}
+
+/**
+ @kernel_helper_function="KrnlHlprCalloutStatisticsReset"
+
+   Purpose:  Zero every processor's counters.                                                   <br>
+                                                                                                <br>
+   Notes:    Classifies in flight on other processors may land just after the reset.            <br>
+                                                                                                <br>
+   MSDN_Ref:                                                                                    <br>
+*/
+_IRQL_requires_min_(PASSIVE_LEVEL)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_IRQL_requires_same_
+_Success_(return == STATUS_SUCCESS)
+NTSTATUS KrnlHlprCalloutStatisticsReset(_Inout_opt_ CALLOUT_STATISTICS* pStatistics)
+{
+#if DBG
+
+   DbgPrintEx(DPFLTR_IHVNETWORK_ID,
+              DPFLTR_INFO_LEVEL,
+              " ---> KrnlHlprCalloutStatisticsReset()\n");
+
+#endif /// DBG
+
+   NTSTATUS status = STATUS_SUCCESS;
+
+   if(pStatistics)
+   {
+      for(UINT32 processorIndex = 0;
+          processorIndex < pStatistics->processorCount;
+          processorIndex++)
+      {
+         RtlZeroMemory(pStatistics->pProcessors[processorIndex].pCounters,
+                       sizeof(pStatistics->pProcessors[processorIndex].pCounters));
+      }
+   }
+   else
+      status = STATUS_NOT_SUPPORTED;
+
+#if DBG
+
+   DbgPrintEx(DPFLTR_IHVNETWORK_ID,
+              DPFLTR_INFO_LEVEL,
+              " <--- KrnlHlprCalloutStatisticsReset() [status: %#x]\n",
+              status);
+
+#endif /// DBG
+
+   return status;
+}
+
+/**
+ @kernel_helper_function="KrnlHlprCalloutStatisticsDestroy"
+
+   Purpose:  Free the counters allocated by KrnlHlprCalloutStatisticsCreate.                    <br>
+                                                                                                <br>
+   Notes:    Callouts must be unregistered first so no wrapper is still running.                <br>
+                                                                                                <br>
+   MSDN_Ref:                                                                                    <br>
+*/
+_At_(*ppStatistics, _Pre_ _Notnull_)
+_At_(*ppStatistics, _Post_ _Null_ __drv_freesMem(Pool))
+_IRQL_requires_min_(PASSIVE_LEVEL)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_IRQL_requires_same_
+_Success_(*ppStatistics == 0)
+VOID KrnlHlprCalloutStatisticsDestroy(_Inout_ CALLOUT_STATISTICS** ppStatistics)
+{
+#if DBG
+
+   DbgPrintEx(DPFLTR_IHVNETWORK_ID,
+              DPFLTR_INFO_LEVEL,
+              " ---> KrnlHlprCalloutStatisticsDestroy()\n");
+
+#endif /// DBG
+
+   NT_ASSERT(ppStatistics);
+
+   if(*ppStatistics)
+   {
+      HLPR_DELETE_ARRAY((*ppStatistics)->pProcessors,
+                        WFPSAMPLER_CALLOUT_DRIVER_TAG);
+
+      HLPR_DELETE(*ppStatistics,
+                  WFPSAMPLER_CALLOUT_DRIVER_TAG);
+   }
+
+#if DBG
+
+   DbgPrintEx(DPFLTR_IHVNETWORK_ID,
+              DPFLTR_INFO_LEVEL,
+              " <--- KrnlHlprCalloutStatisticsDestroy()\n");
+
+#endif /// DBG
+
+   return;
+}
+
+/**
+ @kernel_helper_function="KrnlHlprCalloutStatisticsCreate"
+
+   Purpose:  Allocate a cache aligned block of counters for every active processor.             <br>
+                                                                                                <br>
+   Notes:                                                                                       <br>
+                                                                                                <br>
+   MSDN_Ref: HTTP://MSDN.Microsoft.com/En-US/Library/Windows/Hardware/FF552075.aspx             <br>
+*/
+_At_(*ppStatistics, _Pre_ _Null_)
+_When_(return != STATUS_SUCCESS, _At_(*ppStatistics, _Post_ _Null_))
+_When_(return == STATUS_SUCCESS, _At_(*ppStatistics, _Post_ _Notnull_ __drv_allocatesMem(Pool)))
+_IRQL_requires_(PASSIVE_LEVEL)
+_IRQL_requires_same_
+_Check_return_
+_Success_(return == STATUS_SUCCESS)
+NTSTATUS KrnlHlprCalloutStatisticsCreate(_Outptr_ CALLOUT_STATISTICS** ppStatistics)
+{
+#if DBG
+
+   DbgPrintEx(DPFLTR_IHVNETWORK_ID,
+              DPFLTR_INFO_LEVEL,
+              " ---> KrnlHlprCalloutStatisticsCreate()\n");
+
+#endif /// DBG
+
+   NT_ASSERT(ppStatistics);
+
+   NTSTATUS            status         = STATUS_SUCCESS;
+   CALLOUT_STATISTICS* pStatistics    = 0;
+   UINT32              processorCount = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+
+   HLPR_NEW(pStatistics,
+            CALLOUT_STATISTICS,
+            WFPSAMPLER_CALLOUT_DRIVER_TAG);
+   HLPR_BAIL_ON_ALLOC_FAILURE(pStatistics,
+                              status);
+
+   pStatistics->processorCount = processorCount;
+
+   HLPR_NEW_ARRAY(pStatistics->pProcessors,
+                  CALLOUT_STATISTICS_PROCESSOR,
+                  processorCount,
+                  WFPSAMPLER_CALLOUT_DRIVER_TAG);
+   HLPR_BAIL_ON_ALLOC_FAILURE(pStatistics->pProcessors,
+                              status);
+
+   *ppStatistics = pStatistics;
+
+   HLPR_BAIL_LABEL:
+
+   if(status != STATUS_SUCCESS &&
+      pStatistics)
+      KrnlHlprCalloutStatisticsDestroy(&pStatistics);
+
+#if DBG
+
+   DbgPrintEx(DPFLTR_IHVNETWORK_ID,
+              DPFLTR_INFO_LEVEL,
+              " <--- KrnlHlprCalloutStatisticsCreate() [status: %#x]\n",
+              status);
+
+#endif /// DBG
+
+   return status;
+}
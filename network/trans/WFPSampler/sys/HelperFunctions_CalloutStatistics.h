@@ -0,0 +1,76 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//   Copyright (c) 2014 Microsoft Corporation.  All Rights Reserved.
+//
+//   Module Name:
+//      HelperFunctions_CalloutStatistics.h
+//
+//   Abstract:
+//      This module contains prototypes for kernel helper functions that time every classifyFn and
+//         keep per-processor hit and latency counters for each callout family.
+//
+//   Author:
+//      Dusty Harper      (DHarper)
+//
+//   Revision History:
+//
+//      [ Month ][Day] [Year] - [Revision]-[ Comments ]
+//      May       01,   2010  -     1.0   -  Creation
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef HELPERFUNCTIONS_CALLOUT_STATISTICS_H
+#define HELPERFUNCTIONS_CALLOUT_STATISTICS_H
+
+typedef struct DECLSPEC_CACHEALIGN CALLOUT_STATISTICS_PROCESSOR_
+{
+   CALLOUT_STATISTICS_COUNTERS pCounters[CALLOUT_STATISTICS_MAX];
+}CALLOUT_STATISTICS_PROCESSOR, *PCALLOUT_STATISTICS_PROCESSOR;
+
+typedef struct CALLOUT_STATISTICS_
+{
+   UINT32                        processorCount;
+   CALLOUT_STATISTICS_PROCESSOR* pProcessors;
+}CALLOUT_STATISTICS, *PCALLOUT_STATISTICS;
+
+/// Non-zero only when the CalloutStatistics registry value was set when the driver loaded
+extern CALLOUT_STATISTICS* g_pCalloutStatistics;
+
+_IRQL_requires_(PASSIVE_LEVEL)
+_IRQL_requires_same_
+VOID KrnlHlprCalloutStatisticsInstrument(_Inout_ FWPS_CALLOUT* pCallout);
+
+_IRQL_requires_min_(PASSIVE_LEVEL)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_IRQL_requires_same_
+_Check_return_
+_Success_(return == STATUS_SUCCESS || return == STATUS_BUFFER_OVERFLOW)
+NTSTATUS KrnlHlprCalloutStatisticsQuery(_In_opt_ const CALLOUT_STATISTICS* pStatistics,
+                                        _Out_writes_bytes_to_(bufferSize, *pBytesWritten) VOID* pBuffer,
+                                        _In_ size_t bufferSize,
+                                        _Out_ size_t* pBytesWritten);
+
+_IRQL_requires_min_(PASSIVE_LEVEL)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_IRQL_requires_same_
+_Success_(return == STATUS_SUCCESS)
+NTSTATUS KrnlHlprCalloutStatisticsReset(_Inout_opt_ CALLOUT_STATISTICS* pStatistics);
+
+_At_(*ppStatistics, _Pre_ _Notnull_)
+_At_(*ppStatistics, _Post_ _Null_ __drv_freesMem(Pool))
+_IRQL_requires_min_(PASSIVE_LEVEL)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_IRQL_requires_same_
+_Success_(*ppStatistics == 0)
+VOID KrnlHlprCalloutStatisticsDestroy(_Inout_ CALLOUT_STATISTICS** ppStatistics);
+
+_At_(*ppStatistics, _Pre_ _Null_)
+_When_(return != STATUS_SUCCESS, _At_(*ppStatistics, _Post_ _Null_))
+_When_(return == STATUS_SUCCESS, _At_(*ppStatistics, _Post_ _Notnull_ __drv_allocatesMem(Pool)))
+_IRQL_requires_(PASSIVE_LEVEL)
+_IRQL_requires_same_
+_Check_return_
+_Success_(return == STATUS_SUCCESS)
+NTSTATUS KrnlHlprCalloutStatisticsCreate(_Outptr_ CALLOUT_STATISTICS** ppStatistics);
+
+#endif /// HELPERFUNCTIONS_CALLOUT_STATISTICS_H
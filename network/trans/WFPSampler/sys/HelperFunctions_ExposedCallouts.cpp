@@ -486,6 +486,8 @@ NTSTATUS KrnlHlprExposedCalloutsRegister()
       if(ppRegisteredCallouts[calloutIndex] &&
          ppRegisteredCallouts[calloutIndex]->classifyFn)
       {
+         KrnlHlprCalloutStatisticsInstrument(ppRegisteredCallouts[calloutIndex]);
+
          status = FwpsCalloutRegister(g_pWDMDevice,
                                       ppRegisteredCallouts[calloutIndex],
                                       0);
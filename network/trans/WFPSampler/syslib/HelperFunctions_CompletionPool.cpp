@@ -0,0 +1,493 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//   Copyright (c) 2014 Microsoft Corporation.  All Rights Reserved.
+//
+//   Module Name:
+//      HelperFunctions_CompletionPool.cpp
+//
+//   Abstract:
+//      This module contains kernel helper functions that assist with per-processor pools of
+//         pre-allocated injection completion contexts.  The packet injection callouts take one
+//         context per injected clone and hand it back from their completionFn, so at line rate
+//         the allocator is reduced to a lock-free pop / push on the current processor's list.
+//
+//   Naming Convention:
+//
+//      <Module><Object><Action>
+//
+//      i.e.
+//
+//       KrnlHlprCompletionPoolAcquire
+//
+//       <Module>
+//          KrnlHlpr       -       Function is located in syslib\ and applies to kernel mode.
+//       <Object>
+//          CompletionPool -       Function pertains to COMPLETION_POOL objects.
+//       <Action>
+//          {
+//            Acquire      -       Function takes a context from the pool.
+//            Create       -       Function allocates and fills memory.
+//            Destroy      -       Function cleans up and frees memory.
+//            Populate     -       Function fills memory with values.
+//            Purge        -       Function cleans up values.
+//            QueryCounters-       Function reports the pool's utilization.
+//            Release      -       Function returns a context to the pool.
+//          }
+//
+//   Private Functions:
+//
+//   Public Functions:
+//      KrnlHlprCompletionPoolAcquire(),
+//      KrnlHlprCompletionPoolCreate(),
+//      KrnlHlprCompletionPoolDestroy(),
+//      KrnlHlprCompletionPoolPopulate(),
+//      KrnlHlprCompletionPoolPurge(),
+//      KrnlHlprCompletionPoolQueryCounters(),
+//      KrnlHlprCompletionPoolRelease(),
+//
+//   Author:
+//      Dusty Harper      (DHarper)
+//
+//   Revision History:
+//
+//      [ Month ][Day] [Year] - [Revision]-[ Comments ]
+//      May       01,   2010  -     1.0   -  Creation
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "HelperFunctions_Include.h"          /// .
+#include "HelperFunctions_CompletionPool.tmh" /// $(OBJ_PATH)\$(O)\
+
+/**
+ @kernel_helper_function="KrnlHlprCompletionPoolAcquire"
+
+   Purpose:  Take a zeroed context from the current processor's free list.                      <br>
+                                                                                                <br>
+   Notes:    If the free list is exhausted, the context is allocated from NonPagedPoolNx and
+             will be freed rather than recycled when it is released.                           <br>
+                                                                                                <br>
+   MSDN_Ref: HTTP://MSDN.Microsoft.com/En-US/Library/Windows/Hardware/FF547775.aspx             <br>
+             HTTP://MSDN.Microsoft.com/En-US/Library/Windows/Hardware/FF552976.aspx             <br>
+*/
+_IRQL_requires_min_(PASSIVE_LEVEL)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_IRQL_requires_same_
+_Check_return_
+_Ret_maybenull_
+VOID* KrnlHlprCompletionPoolAcquire(_Inout_ COMPLETION_POOL* pPool)
+{
+   NT_ASSERT(pPool);
+   NT_ASSERT(pPool->pProcessors);
+
+   UINT32                        processorIndex = KeGetCurrentProcessorNumberEx(0) % pPool->processorCount;
+   COMPLETION_POOL_PROCESSOR*    pProcessor     = &(pPool->pProcessors[processorIndex]);
+   COMPLETION_POOL_ENTRY_HEADER* pHeader        = 0;
+   VOID*                         pContext       = 0;
+   LONG                          outstanding    = 0;
+   LONG                          highWaterMark  = 0;
+
+   pHeader = (COMPLETION_POOL_ENTRY_HEADER*)InterlockedPopEntrySList(&(pProcessor->freeList));
+   if(pHeader == 0)
+   {
+      InterlockedIncrement64(&(pProcessor->misses));
+
+      pHeader = (COMPLETION_POOL_ENTRY_HEADER*)ExAllocatePoolWithTag(NonPagedPoolNx,
+                                                                     pPool->entrySize,
+                                                                     pPool->memoryTag);
+      HLPR_BAIL_ON_NULL_POINTER(pHeader);
+
+      pHeader->processorIndex = processorIndex;
+      pHeader->isPooled       = FALSE;
+   }
+
+   InterlockedIncrement64(&(pProcessor->acquisitions));
+
+   outstanding = InterlockedIncrement(&(pProcessor->outstanding));
+
+   for(highWaterMark = pProcessor->highWaterMark;
+       outstanding > highWaterMark;
+       highWaterMark = pProcessor->highWaterMark)
+   {
+      if(InterlockedCompareExchange(&(pProcessor->highWaterMark),
+                                    outstanding,
+                                    highWaterMark) == highWaterMark)
+         break;
+   }
+
+   pContext = &(pHeader[1]);
+
+   RtlZeroMemory(pContext,
+                 pPool->contextSize);
+
+   HLPR_BAIL_LABEL:
+
+   return pContext;
+}
+
+/**
+ @kernel_helper_function="KrnlHlprCompletionPoolRelease"
+
+   Purpose:  Return a context obtained from KrnlHlprCompletionPoolAcquire.                      <br>
+                                                                                                <br>
+   Notes:    Pooled contexts go back to the list of the processor they were acquired on, so a
+             processor that only completes injections does not drain another's list.            <br>
+                                                                                                <br>
+   MSDN_Ref: HTTP://MSDN.Microsoft.com/En-US/Library/Windows/Hardware/FF547799.aspx             <br>
+*/
+_IRQL_requires_min_(PASSIVE_LEVEL)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_IRQL_requires_same_
+VOID KrnlHlprCompletionPoolRelease(_Inout_ COMPLETION_POOL* pPool,
+                                   _In_ VOID* pContext)
+{
+   NT_ASSERT(pPool);
+   NT_ASSERT(pContext);
+
+   COMPLETION_POOL_ENTRY_HEADER* pHeader    = ((COMPLETION_POOL_ENTRY_HEADER*)pContext) - 1;
+   COMPLETION_POOL_PROCESSOR*    pProcessor = 0;
+
+   NT_ASSERT(pHeader->processorIndex < pPool->processorCount);
+
+   pProcessor = &(pPool->pProcessors[pHeader->processorIndex]);
+
+   InterlockedDecrement(&(pProcessor->outstanding));
+
+   if(pHeader->isPooled)
+      InterlockedPushEntrySList(&(pProcessor->freeList),
+                                &(pHeader->entry));
+   else
+      ExFreePoolWithTag(pHeader,
+                        pPool->memoryTag);
+
+   return;
+}
+
+/**
+ @kernel_helper_function="KrnlHlprCompletionPoolQueryCounters"
+
+   Purpose:  Sum the per-processor utilization counters of a COMPLETION_POOL.                   <br>
+                                                                                                <br>
+   Notes:    The counters are sampled without synchronization, so the totals are approximate
+             while injections are in flight.                                                    <br>
+                                                                                                <br>
+   MSDN_Ref:                                                                                    <br>
+*/
+_IRQL_requires_min_(PASSIVE_LEVEL)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_IRQL_requires_same_
+VOID KrnlHlprCompletionPoolQueryCounters(_In_ const COMPLETION_POOL* pPool,
+                                         _Out_ COMPLETION_POOL_COUNTERS* pCounters)
+{
+   NT_ASSERT(pPool);
+   NT_ASSERT(pCounters);
+
+   RtlZeroMemory(pCounters,
+                 sizeof(COMPLETION_POOL_COUNTERS));
+
+   pCounters->capacity = pPool->processorCount * pPool->entriesPerProcessor;
+
+   for(UINT32 index = 0;
+       pPool->pProcessors &&
+       index < pPool->processorCount;
+       index++)
+   {
+      const COMPLETION_POOL_PROCESSOR* pProcessor = &(pPool->pProcessors[index]);
+
+      pCounters->acquisitions += pProcessor->acquisitions;
+      pCounters->misses       += pProcessor->misses;
+      pCounters->outstanding  += pProcessor->outstanding;
+
+      if((UINT32)pProcessor->highWaterMark > pCounters->highWaterMark)
+         pCounters->highWaterMark = pProcessor->highWaterMark;
+   }
+
+   return;
+}
+
+/**
+ @kernel_helper_function="KrnlHlprCompletionPoolPurge"
+
+   Purpose:  Cleanup a COMPLETION_POOL object.                                                  <br>
+                                                                                                <br>
+   Notes:    All contexts must have been released (i.e. all injections completed).             <br>
+                                                                                                <br>
+   MSDN_Ref: HTTP://MSDN.Microsoft.com/En-US/Library/Windows/Hardware/FF544593.aspx             <br>
+*/
+_IRQL_requires_min_(PASSIVE_LEVEL)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_IRQL_requires_same_
+VOID KrnlHlprCompletionPoolPurge(_Inout_ COMPLETION_POOL* pPool)
+{
+#if DBG
+
+   DbgPrintEx(DPFLTR_IHVNETWORK_ID,
+              DPFLTR_INFO_LEVEL,
+              " ---> KrnlHlprCompletionPoolPurge()\n");
+
+#endif /// DBG
+
+   NT_ASSERT(pPool);
+
+#if DBG
+
+   if(pPool->pProcessors)
+   {
+      COMPLETION_POOL_COUNTERS counters = {0};
+
+      KrnlHlprCompletionPoolQueryCounters(pPool,
+                                          &counters);
+
+      NT_ASSERT(counters.outstanding == 0);
+
+      DbgPrintEx(DPFLTR_IHVNETWORK_ID,
+                 DPFLTR_INFO_LEVEL,
+                 "   KrnlHlprCompletionPoolPurge() [Acquisitions: %I64u][Misses: %I64u][HighWaterMark: %u][Capacity: %u]\n",
+                 counters.acquisitions,
+                 counters.misses,
+                 counters.highWaterMark,
+                 counters.capacity);
+   }
+
+#endif /// DBG
+
+   HLPR_DELETE_ARRAY(pPool->pProcessors,
+                     pPool->memoryTag);
+
+   HLPR_DELETE_ARRAY(pPool->pEntries,
+                     pPool->memoryTag);
+
+   RtlZeroMemory(pPool,
+                 sizeof(COMPLETION_POOL));
+
+#if DBG
+
+   DbgPrintEx(DPFLTR_IHVNETWORK_ID,
+              DPFLTR_INFO_LEVEL,
+              " <--- KrnlHlprCompletionPoolPurge()\n");
+
+#endif /// DBG
+
+   return;
+}
+
+/**
+ @kernel_helper_function="KrnlHlprCompletionPoolDestroy"
+
+   Purpose:  Cleanup and free a COMPLETION_POOL object.                                         <br>
+                                                                                                <br>
+   Notes:                                                                                       <br>
+                                                                                                <br>
+   MSDN_Ref:                                                                                    <br>
+*/
+_At_(*ppPool, _Pre_ _Notnull_)
+_At_(*ppPool, _Post_ _Null_ __drv_freesMem(Pool))
+_IRQL_requires_min_(PASSIVE_LEVEL)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_IRQL_requires_same_
+_Success_(*ppPool == 0)
+VOID KrnlHlprCompletionPoolDestroy(_Inout_ COMPLETION_POOL** ppPool)
+{
+#if DBG
+
+   DbgPrintEx(DPFLTR_IHVNETWORK_ID,
+              DPFLTR_INFO_LEVEL,
+              " ---> KrnlHlprCompletionPoolDestroy()\n");
+
+#endif /// DBG
+
+   NT_ASSERT(ppPool);
+
+   if(*ppPool)
+   {
+      KrnlHlprCompletionPoolPurge(*ppPool);
+
+      HLPR_DELETE(*ppPool,
+                  WFPSAMPLER_SYSLIB_TAG);
+   }
+
+#if DBG
+
+   DbgPrintEx(DPFLTR_IHVNETWORK_ID,
+              DPFLTR_INFO_LEVEL,
+              " <--- KrnlHlprCompletionPoolDestroy()\n");
+
+#endif /// DBG
+
+   return;
+}
+
+/**
+ @kernel_helper_function="KrnlHlprCompletionPoolPopulate"
+
+   Purpose:  Pre-allocate entriesPerProcessor contexts of contextSize bytes for every active
+             processor and seed each processor's free list with them.                          <br>
+                                                                                                <br>
+   Notes:    Contexts are aligned to MEMORY_ALLOCATION_ALIGNMENT.                               <br>
+                                                                                                <br>
+   MSDN_Ref: HTTP://MSDN.Microsoft.com/En-US/Library/Windows/Hardware/FF552075.aspx             <br>
+             HTTP://MSDN.Microsoft.com/En-US/Library/Windows/Hardware/FF547820.aspx             <br>
+*/
+_IRQL_requires_(PASSIVE_LEVEL)
+_IRQL_requires_same_
+_Check_return_
+_Success_(return == STATUS_SUCCESS)
+NTSTATUS KrnlHlprCompletionPoolPopulate(_Inout_ COMPLETION_POOL* pPool,
+                                        _In_ UINT32 contextSize,
+                                        _In_ UINT32 entriesPerProcessor, /* COMPLETION_POOL_ENTRIES_PER_PROCESSOR */
+                                        _In_opt_ UINT32 memoryTag)       /* WFPSAMPLER_SYSLIB_TAG */
+{
+#if DBG
+
+   DbgPrintEx(DPFLTR_IHVNETWORK_ID,
+              DPFLTR_INFO_LEVEL,
+              " ---> KrnlHlprCompletionPoolPopulate()\n");
+
+#endif /// DBG
+
+   NT_ASSERT(pPool);
+   NT_ASSERT(contextSize);
+
+   NTSTATUS status     = STATUS_SUCCESS;
+   size_t   entryCount = 0;
+   size_t   totalSize  = 0;
+
+   pPool->processorCount      = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+   pPool->entriesPerProcessor = entriesPerProcessor;
+   pPool->contextSize         = contextSize;
+   pPool->entrySize           = (UINT32)((sizeof(COMPLETION_POOL_ENTRY_HEADER) + contextSize + (MEMORY_ALLOCATION_ALIGNMENT - 1)) &
+                                         ~((size_t)MEMORY_ALLOCATION_ALIGNMENT - 1));
+   pPool->memoryTag           = memoryTag;
+
+   HLPR_NEW_ARRAY(pPool->pProcessors,
+                  COMPLETION_POOL_PROCESSOR,
+                  pPool->processorCount,
+                  memoryTag);
+   HLPR_BAIL_ON_ALLOC_FAILURE(pPool->pProcessors,
+                              status);
+
+   status = RtlSizeTMult(pPool->processorCount,
+                         entriesPerProcessor,
+                         &entryCount);
+   HLPR_BAIL_ON_FAILURE(status);
+
+   status = RtlSizeTMult(entryCount,
+                         pPool->entrySize,
+                         &totalSize);
+   HLPR_BAIL_ON_FAILURE(status);
+
+   if(totalSize)
+   {
+      HLPR_NEW_ARRAY(pPool->pEntries,
+                     BYTE,
+                     totalSize,
+                     memoryTag);
+      HLPR_BAIL_ON_ALLOC_FAILURE(pPool->pEntries,
+                                 status);
+   }
+
+   for(UINT32 processorIndex = 0;
+       processorIndex < pPool->processorCount;
+       processorIndex++)
+   {
+      COMPLETION_POOL_PROCESSOR* pProcessor = &(pPool->pProcessors[processorIndex]);
+
+      InitializeSListHead(&(pProcessor->freeList));
+
+      for(UINT32 entryIndex = 0;
+          entryIndex < entriesPerProcessor;
+          entryIndex++)
+      {
+         COMPLETION_POOL_ENTRY_HEADER* pHeader = (COMPLETION_POOL_ENTRY_HEADER*)(pPool->pEntries +
+                                                 (((size_t)processorIndex * entriesPerProcessor) + entryIndex) * pPool->entrySize);
+
+         pHeader->processorIndex = processorIndex;
+         pHeader->isPooled       = TRUE;
+
+         InterlockedPushEntrySList(&(pProcessor->freeList),
+                                   &(pHeader->entry));
+      }
+   }
+
+   HLPR_BAIL_LABEL:
+
+   if(status != STATUS_SUCCESS)
+      KrnlHlprCompletionPoolPurge(pPool);
+
+#if DBG
+
+   DbgPrintEx(DPFLTR_IHVNETWORK_ID,
+              DPFLTR_INFO_LEVEL,
+              " <--- KrnlHlprCompletionPoolPopulate() [status: %#x]\n",
+              status);
+
+#endif /// DBG
+
+   return status;
+}
+
+/**
+ @kernel_helper_function="KrnlHlprCompletionPoolCreate"
+
+   Purpose:  Allocates and populates a COMPLETION_POOL object.                                  <br>
+                                                                                                <br>
+   Notes:                                                                                       <br>
+                                                                                                <br>
+   MSDN_Ref:                                                                                    <br>
+*/
+_At_(*ppPool, _Pre_ _Null_)
+_When_(return != STATUS_SUCCESS, _At_(*ppPool, _Post_ _Null_))
+_When_(return == STATUS_SUCCESS, _At_(*ppPool, _Post_ _Notnull_ __drv_allocatesMem(Pool)))
+_IRQL_requires_(PASSIVE_LEVEL)
+_IRQL_requires_same_
+_Check_return_
+_Success_(return == STATUS_SUCCESS)
+NTSTATUS KrnlHlprCompletionPoolCreate(_Outptr_ COMPLETION_POOL** ppPool,
+                                      _In_ UINT32 contextSize,
+                                      _In_ UINT32 entriesPerProcessor, /* COMPLETION_POOL_ENTRIES_PER_PROCESSOR */
+                                      _In_opt_ UINT32 memoryTag)       /* WFPSAMPLER_SYSLIB_TAG */
+{
+#if DBG
+
+   DbgPrintEx(DPFLTR_IHVNETWORK_ID,
+              DPFLTR_INFO_LEVEL,
+              " ---> KrnlHlprCompletionPoolCreate()\n");
+
+#endif /// DBG
+
+   NT_ASSERT(ppPool);
+
+   NTSTATUS status = STATUS_SUCCESS;
+
+   HLPR_NEW(*ppPool,
+            COMPLETION_POOL,
+            WFPSAMPLER_SYSLIB_TAG);
+   HLPR_BAIL_ON_ALLOC_FAILURE(*ppPool,
+                              status);
+
+   status = KrnlHlprCompletionPoolPopulate(*ppPool,
+                                           contextSize,
+                                           entriesPerProcessor,
+                                           memoryTag);
+
+   HLPR_BAIL_LABEL:
+
+#pragma warning(push)
+#pragma warning(disable: 6001) /// *ppPool initialized with calls to HLPR_NEW & KrnlHlprCompletionPoolPopulate
+
+   if(status != STATUS_SUCCESS &&
+      *ppPool)
+      KrnlHlprCompletionPoolDestroy(ppPool);
+
+#pragma warning(pop)
+
+#if DBG
+
+   DbgPrintEx(DPFLTR_IHVNETWORK_ID,
+              DPFLTR_INFO_LEVEL,
+              " <--- KrnlHlprCompletionPoolCreate() [status: %#x]\n",
+              status);
+
+#endif /// DBG
+
+   return status;
+}
@@ -0,0 +1,118 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//   Copyright (c) 2014 Microsoft Corporation.  All Rights Reserved.
+//
+//   Module Name:
+//      HelperFunctions_CompletionPool.h
+//
+//   Abstract:
+//      This module contains prototypes for kernel helper functions that assist with per-processor
+//         pools of pre-allocated injection completion contexts.
+//
+//   Author:
+//      Dusty Harper      (DHarper)
+//
+//   Revision History:
+//
+//      [ Month ][Day] [Year] - [Revision]-[ Comments ]
+//      May       01,   2010  -     1.0   -  Creation
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef HELPERFUNCTIONS_COMPLETION_POOL_H
+#define HELPERFUNCTIONS_COMPLETION_POOL_H
+
+#define COMPLETION_POOL_ENTRIES_PER_PROCESSOR 256
+
+/// Precedes every context handed out by the pool.  Contexts are returned to the free list of the
+/// processor they were carved for, no matter which processor completes them.
+typedef struct DECLSPEC_ALIGN(MEMORY_ALLOCATION_ALIGNMENT) COMPLETION_POOL_ENTRY_HEADER_
+{
+   SLIST_ENTRY entry;
+   UINT32      processorIndex;
+   BOOLEAN     isPooled;
+}COMPLETION_POOL_ENTRY_HEADER, *PCOMPLETION_POOL_ENTRY_HEADER;
+
+typedef struct DECLSPEC_CACHEALIGN COMPLETION_POOL_PROCESSOR_
+{
+   SLIST_HEADER    freeList;
+   volatile LONG   outstanding;
+   volatile LONG   highWaterMark;
+   volatile LONG64 acquisitions;
+   volatile LONG64 misses;
+}COMPLETION_POOL_PROCESSOR, *PCOMPLETION_POOL_PROCESSOR;
+
+typedef struct COMPLETION_POOL_COUNTERS_
+{
+   UINT64 acquisitions;  /// contexts handed out
+   UINT64 misses;        /// acquisitions that fell back to ExAllocatePoolWithTag (free list empty)
+   UINT32 outstanding;   /// contexts currently owned by pending injections
+   UINT32 highWaterMark; /// largest number of contexts outstanding on any one processor
+   UINT32 capacity;      /// pre-allocated contexts across all processors
+}COMPLETION_POOL_COUNTERS, *PCOMPLETION_POOL_COUNTERS;
+
+typedef struct COMPLETION_POOL_
+{
+   UINT32                     processorCount;
+   UINT32                     entriesPerProcessor;
+   UINT32                     entrySize;           /// header + context, rounded to the alignment
+   UINT32                     contextSize;
+   UINT32                     memoryTag;
+   BYTE*                      pEntries;
+   COMPLETION_POOL_PROCESSOR* pProcessors;
+}COMPLETION_POOL, *PCOMPLETION_POOL;
+
+_IRQL_requires_min_(PASSIVE_LEVEL)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_IRQL_requires_same_
+_Check_return_
+_Ret_maybenull_
+VOID* KrnlHlprCompletionPoolAcquire(_Inout_ COMPLETION_POOL* pPool);
+
+_IRQL_requires_min_(PASSIVE_LEVEL)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_IRQL_requires_same_
+VOID KrnlHlprCompletionPoolRelease(_Inout_ COMPLETION_POOL* pPool,
+                                   _In_ VOID* pContext);
+
+_IRQL_requires_min_(PASSIVE_LEVEL)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_IRQL_requires_same_
+VOID KrnlHlprCompletionPoolQueryCounters(_In_ const COMPLETION_POOL* pPool,
+                                         _Out_ COMPLETION_POOL_COUNTERS* pCounters);
+
+_IRQL_requires_min_(PASSIVE_LEVEL)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_IRQL_requires_same_
+VOID KrnlHlprCompletionPoolPurge(_Inout_ COMPLETION_POOL* pPool);
+
+_At_(*ppPool, _Pre_ _Notnull_)
+_At_(*ppPool, _Post_ _Null_ __drv_freesMem(Pool))
+_IRQL_requires_min_(PASSIVE_LEVEL)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_IRQL_requires_same_
+_Success_(*ppPool == 0)
+VOID KrnlHlprCompletionPoolDestroy(_Inout_ COMPLETION_POOL** ppPool);
+
+_IRQL_requires_(PASSIVE_LEVEL)
+_IRQL_requires_same_
+_Check_return_
+_Success_(return == STATUS_SUCCESS)
+NTSTATUS KrnlHlprCompletionPoolPopulate(_Inout_ COMPLETION_POOL* pPool,
+                                        _In_ UINT32 contextSize,
+                                        _In_ UINT32 entriesPerProcessor = COMPLETION_POOL_ENTRIES_PER_PROCESSOR,
+                                        _In_opt_ UINT32 memoryTag = WFPSAMPLER_SYSLIB_TAG);
+
+_At_(*ppPool, _Pre_ _Null_)
+_When_(return != STATUS_SUCCESS, _At_(*ppPool, _Post_ _Null_))
+_When_(return == STATUS_SUCCESS, _At_(*ppPool, _Post_ _Notnull_ __drv_allocatesMem(Pool)))
+_IRQL_requires_(PASSIVE_LEVEL)
+_IRQL_requires_same_
+_Check_return_
+_Success_(return == STATUS_SUCCESS)
+NTSTATUS KrnlHlprCompletionPoolCreate(_Outptr_ COMPLETION_POOL** ppPool,
+                                      _In_ UINT32 contextSize,
+                                      _In_ UINT32 entriesPerProcessor = COMPLETION_POOL_ENTRIES_PER_PROCESSOR,
+                                      _In_opt_ UINT32 memoryTag = WFPSAMPLER_SYSLIB_TAG);
+
+#endif /// HELPERFUNCTIONS_COMPLETION_POOL_H
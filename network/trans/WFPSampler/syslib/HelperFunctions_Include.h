@@ -30,6 +30,7 @@
 #include "HelperFunctions_FwpObjects.h"             /// .
 #include "HelperFunctions_FlowContext.h"            /// .
 #include "HelperFunctions_ClassifyData.h"           /// .
+#include "HelperFunctions_CompletionPool.h"         /// .
 #include "HelperFunctions_NotifyData.h"             /// .
 #include "HelperFunctions_InjectionData.h"          /// .
 #include "HelperFunctions_NetBuffer.h"              /// .
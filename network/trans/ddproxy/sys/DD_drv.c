@@ -22,6 +22,8 @@ Abstract:
     o  DestinationPortToIntercept (REG_DWORD) : applicable if InspectUdp is 1
     o  NewDestinationAddress(REG_SZ) : literal IPv4/IPv6 string
     o  NewDestinationPort(REG_DWORD)
+    o  RewriteInline (REG_DWORD) : 0 (out-of-band via worker, default); 
+                                   1 (clone-modify-reinject at classify)
 
    The sample is IP version agnostic. It performs proxying for both IPv4 
    and IPv6 traffic.
@@ -59,6 +61,8 @@ Environment:
 
 BOOLEAN configInspectUdp = TRUE;
 
+BOOLEAN configRewriteInline = FALSE;
+
 UINT16   configInspectDestPort = 5001;
 UINT8*   configInspectDestAddrV4 = NULL;
 UINT8*   configInspectDestAddrV6 = NULL;
@@ -128,6 +132,12 @@ UINT32 gFlowEstablishedCalloutIdV6, gCalloutIdV6;
 
 HANDLE gInjectionHandle;
 
+NDIS_GENERIC_OBJECT* gNdisGenericObj;
+NDIS_HANDLE gNetBufferListPool;
+
+NPAGED_LOOKASIDE_LIST gPendedPacketLookaside;
+BOOLEAN gPendedPacketLookasideInitialized = FALSE;
+
 LIST_ENTRY gFlowList;
 KSPIN_LOCK gFlowListLock;
 
@@ -210,6 +220,7 @@ DDProxyLoadConfig(
    DECLARE_CONST_UNICODE_STRING(destPortValueName, L"DestinationPortToIntercept");
    DECLARE_CONST_UNICODE_STRING(newDestAddrValueName, L"NewDestinationAddress");
    DECLARE_CONST_UNICODE_STRING(newDestPortValueName, L"NewDestinationPort");
+   DECLARE_CONST_UNICODE_STRING(rewriteInlineValueName, L"RewriteInline");
 
    ULONG ulongValue;
 
@@ -273,6 +284,15 @@ DDProxyLoadConfig(
       configNewDestPort = (USHORT) ulongValue;
    }
 
+   if (NT_SUCCESS(WdfRegistryQueryULong(
+                     key,
+                     &rewriteInlineValueName,
+                     &ulongValue
+                     )))
+   {
+      configRewriteInline = (ulongValue != 0);
+   }
+
    return status;
 }
 
@@ -821,6 +841,11 @@ EvtDriverUnload(
    DDProxyUnregisterCallouts();
 
    FwpsInjectionHandleDestroy(gInjectionHandle);
+
+   NdisFreeNetBufferListPool(gNetBufferListPool);
+   NdisFreeGenericObject(gNdisGenericObj);
+
+   ExDeleteNPagedLookasideList(&gPendedPacketLookaside);
 }
 
 //
@@ -918,6 +943,7 @@ DriverEntry(
    WDFDEVICE device;
    WDFKEY configKey;
    HANDLE threadHandle;
+   NET_BUFFER_LIST_POOL_PARAMETERS nblPoolParams = {0};
 
    // Request NX Non-Paged Pool when available
    ExInitializeDriverRuntime(DrvRtPoolNxOptIn);
@@ -983,6 +1009,49 @@ DriverEntry(
       }
    }
 
+   ExInitializeNPagedLookasideList(
+      &gPendedPacketLookaside,
+      NULL,
+      NULL,
+      0,
+      sizeof(DD_PROXY_PENDED_PACKET),
+      DD_PROXY_PENDED_PACKET_POOL_TAG,
+      0
+      );
+   gPendedPacketLookasideInitialized = TRUE;
+
+   gNdisGenericObj = NdisAllocateGenericObject(
+                        driverObject, 
+                        DD_PROXY_NDIS_OBJ_TAG, 
+                        0
+                        );
+
+   if (gNdisGenericObj == NULL)
+   {
+      status = STATUS_NO_MEMORY;
+      goto Exit;
+   }
+
+   nblPoolParams.Header.Type = NDIS_OBJECT_TYPE_DEFAULT;
+   nblPoolParams.Header.Revision = NET_BUFFER_LIST_POOL_PARAMETERS_REVISION_1;
+   nblPoolParams.Header.Size = sizeof(nblPoolParams);
+
+   nblPoolParams.fAllocateNetBuffer = TRUE;
+   nblPoolParams.DataSize = 0;
+
+   nblPoolParams.PoolTag = DD_PROXY_NBL_POOL_TAG;
+
+   gNetBufferListPool = NdisAllocateNetBufferListPool(
+                           gNdisGenericObj,
+                           &nblPoolParams
+                           );
+
+   if (gNetBufferListPool == NULL)
+   {
+      status = STATUS_NO_MEMORY;
+      goto Exit;
+   }
+
    status = FwpsInjectionHandleCreate(
                AF_UNSPEC,
                FWPS_INJECTION_TYPE_TRANSPORT,
@@ -1053,6 +1122,18 @@ Exit:
       {
          FwpsInjectionHandleDestroy(gInjectionHandle);
       }
+      if (gNetBufferListPool != NULL)
+      {
+         NdisFreeNetBufferListPool(gNetBufferListPool);
+      }
+      if (gNdisGenericObj != NULL)
+      {
+         NdisFreeGenericObject(gNdisGenericObj);
+      }
+      if (gPendedPacketLookasideInitialized)
+      {
+         ExDeleteNPagedLookasideList(&gPendedPacketLookaside);
+      }
    }
 
    return status;
@@ -10,11 +10,17 @@ Abstract:
    is also implemented here along with the eventing mechanisms shared between
    the classify function and the worker thread.
 
-   Packet modification is done out-of-band by a system worker thread using 
-   the reference-drop-clone-modify-reinject mechanism. Therefore the sample 
-   can serve as a base in scenarios where filtering/modification decision 
-   cannot be made within the classifyFn() callout and instead must be made, 
-   for example, by an user-mode application.
+   By default packet modification is done out-of-band by a system worker 
+   thread using the reference-drop-clone-modify-reinject mechanism. Therefore 
+   the sample can serve as a base in scenarios where filtering/modification 
+   decision cannot be made within the classifyFn() callout and instead must 
+   be made, for example, by an user-mode application.
+
+   When the RewriteInline registry value is set, the clone is modified and 
+   re-injected directly from the classifyFn() at DISPATCH_LEVEL and the 
+   worker thread is bypassed. Pended packet structures come from a lookaside 
+   list and clones are allocated from a driver-owned net buffer list pool in 
+   both modes, so the per-datagram cost is limited to the clone itself.
 
 Environment:
 
@@ -48,9 +54,19 @@ DDProxyFreePendedPacket(
    {
       ExFreePoolWithTag(controlData, DD_PROXY_CONTROL_DATA_POOL_TAG);
    }
-   ExFreePoolWithTag(packet, DD_PROXY_PENDED_PACKET_POOL_TAG);
+   ExFreeToNPagedLookasideList(&gPendedPacketLookaside, packet);
 }
 
+NTSTATUS
+DDProxyCloneModifyReinjectOutbound(
+   _In_ DD_PROXY_PENDED_PACKET* packet
+   );
+
+NTSTATUS
+DDProxyCloneModifyReinjectInbound(
+   _In_ DD_PROXY_PENDED_PACKET* packet
+   );
+
 #if(NTDDI_VERSION >= NTDDI_WIN7)
 
 void
@@ -289,6 +305,9 @@ DDProxyClassify(
    queue. The worker thread will then be signaled, if idle, to process 
    the queue. 
 
+   If inline rewrite is configured the packet is cloned, modified and 
+   re-injected right here instead, and the worker thread is not involved.
+
 -- */
 {
    DD_PROXY_PENDED_PACKET* packet = NULL;
@@ -334,11 +353,7 @@ DDProxyClassify(
       goto Exit;
    }
 
-   packet = ExAllocatePoolWithTag(
-                     NonPagedPool,
-                     sizeof(DD_PROXY_PENDED_PACKET),
-                     DD_PROXY_PENDED_PACKET_POOL_TAG
-                     );
+   packet = ExAllocateFromNPagedLookasideList(&gPendedPacketLookaside);
 
    if (packet == NULL)
    {
@@ -472,6 +487,40 @@ DDProxyClassify(
          NET_BUFFER_DATA_OFFSET(NET_BUFFER_LIST_FIRST_NB(packet->netBufferList));
    }
 
+   if (configRewriteInline)
+   {
+      NTSTATUS status;
+
+      //
+      // The flow is being classified so it can't have been deleted; the 
+      // clone-modify-reinject functions are safe to call at DISPATCH_LEVEL.
+      //
+      if (packet->direction == FWP_DIRECTION_OUTBOUND)
+      {
+         status = DDProxyCloneModifyReinjectOutbound(packet);
+      }
+      else
+      {
+         status = DDProxyCloneModifyReinjectInbound(packet);
+      }
+
+      if (NT_SUCCESS(status))
+      {
+         packet = NULL; // ownership transferred to the completion function.
+
+         classifyOut->actionType = FWP_ACTION_BLOCK;
+         classifyOut->rights &= ~FWPS_RIGHT_ACTION_WRITE;
+         classifyOut->flags |= FWPS_CLASSIFY_OUT_FLAG_ABSORB;
+      }
+      else
+      {
+         classifyOut->actionType = FWP_ACTION_BLOCK;
+         classifyOut->rights &= ~FWPS_RIGHT_ACTION_WRITE;
+      }
+
+      goto Exit;
+   }
+
    KeAcquireInStackQueuedSpinLock(
       &gPacketQueueLock,
       &packetQueueLockHandle
@@ -603,6 +652,10 @@ void DDProxyInjectComplete(
    DD_PROXY_PENDED_PACKET* packet = context;
    UNREFERENCED_PARAMETER(dispatchLevel);
 
+   //
+   // An outbound clone carries every datagram of the indicated net buffer 
+   // list, so one completion retires the whole batch.
+   //
    FwpsFreeCloneNetBufferList(netBufferList, 0);
 
    DDProxyFreePendedPacket(packet, packet->controlData);
@@ -628,7 +681,7 @@ DDProxyCloneModifyReinjectOutbound(
 
    status = FwpsAllocateCloneNetBufferList(
                packet->netBufferList,
-               NULL,
+               gNetBufferListPool,
                NULL,
                0,
                &clonedNetBufferList
@@ -782,7 +835,7 @@ DDProxyCloneModifyReinjectInbound(
 
    status = FwpsAllocateCloneNetBufferList(
                packet->netBufferList,
-               NULL,
+               gNetBufferListPool,
                NULL,
                0,
                &clonedNetBufferList
@@ -118,6 +118,8 @@ typedef struct DD_PROXY_PENDED_PACKET_
 #define DD_PROXY_FLOW_CONTEXT_POOL_TAG 'olfD'
 #define DD_PROXY_PENDED_PACKET_POOL_TAG 'kppD'
 #define DD_PROXY_CONTROL_DATA_POOL_TAG 'dcdD'
+#define DD_PROXY_NDIS_OBJ_TAG 'odnD'
+#define DD_PROXY_NBL_POOL_TAG 'lbnD'
 
 //
 // Shared global data.
@@ -130,8 +132,13 @@ extern UINT16 configNewDestPort;
 extern UINT8* configNewDestAddrV4;
 extern UINT8* configNewDestAddrV6;
 
+extern BOOLEAN configRewriteInline;
+
 extern HANDLE gInjectionHandle;
 
+extern NDIS_HANDLE gNetBufferListPool;
+extern NPAGED_LOOKASIDE_LIST gPendedPacketLookaside;
+
 extern LIST_ENTRY gFlowList;
 extern KSPIN_LOCK gFlowListLock;
 
@@ -137,6 +137,24 @@ DEFINE_GUID(
     0x99, 0x75, 0x78, 0x7d, 0x51, 0x68, 0xa1, 0x51
 );
 
+// 987f1260-cde1-44db-86fb-f09f51162721
+DEFINE_GUID(
+    TL_INSPECT_ALE_FLOW_ESTABLISHED_CALLOUT_V4,
+    0x987f1260,
+    0xcde1,
+    0x44db,
+    0x86, 0xfb, 0xf0, 0x9f, 0x51, 0x16, 0x27, 0x21
+);
+
+// 7e8016b5-2164-481b-9442-d6dd68c7f184
+DEFINE_GUID(
+    TL_INSPECT_ALE_FLOW_ESTABLISHED_CALLOUT_V6,
+    0x7e8016b5,
+    0x2164,
+    0x481b,
+    0x94, 0x42, 0xd6, 0xdd, 0x68, 0xc7, 0xf1, 0x84
+);
+
 // 2e207682-d95f-4525-b966-969f26587f03
 DEFINE_GUID(
     TL_INSPECT_SUBLAYER,
@@ -158,18 +176,19 @@ UINT32 gAleConnectCalloutIdV4, gOutboundTlCalloutIdV4;
 UINT32 gAleRecvAcceptCalloutIdV4, gInboundTlCalloutIdV4;
 UINT32 gAleConnectCalloutIdV6, gOutboundTlCalloutIdV6;
 UINT32 gAleRecvAcceptCalloutIdV6, gInboundTlCalloutIdV6;
+UINT32 gAleFlowEstablishedCalloutIdV4, gAleFlowEstablishedCalloutIdV6;
 
 HANDLE gInjectionHandle;
 
-LIST_ENTRY gConnList;
-KSPIN_LOCK gConnListLock;
-LIST_ENTRY gPacketQueue;
-KSPIN_LOCK gPacketQueueLock;
+TL_INSPECT_WORK_QUEUE* gWorkQueues;
+ULONG gNumWorkQueues;
+
+LIST_ENTRY gFlowContextList;
+KSPIN_LOCK gFlowContextListLock;
 
-KEVENT gWorkerEvent;
+LONG gVerdictGeneration;
 
 BOOLEAN gDriverUnloading = FALSE;
-void* gThreadObj;
 
 // 
 // Callout driver implementation
@@ -264,6 +283,7 @@ TLInspectAddFilter(
 
       if (IsEqualGUID(layerKey, &FWPM_LAYER_ALE_AUTH_CONNECT_V4) ||
           IsEqualGUID(layerKey, &FWPM_LAYER_ALE_AUTH_RECV_ACCEPT_V4) ||
+          IsEqualGUID(layerKey, &FWPM_LAYER_ALE_FLOW_ESTABLISHED_V4) ||
           IsEqualGUID(layerKey, &FWPM_LAYER_INBOUND_TRANSPORT_V4) ||
           IsEqualGUID(layerKey, &FWPM_LAYER_OUTBOUND_TRANSPORT_V4))
       {
@@ -310,6 +330,12 @@ TLInspectRegisterALEClassifyCallouts(
       FWPM_LAYER_ALE_AUTH_RECV_ACCEPT_V4
       FWPM_LAYER_ALE_AUTH_RECV_ACCEPT_V6
 
+   It also registers them at the following layers to cache the inspection
+   verdict of the flows that get established.
+
+      FWPM_LAYER_ALE_FLOW_ESTABLISHED_V4
+      FWPM_LAYER_ALE_FLOW_ESTABLISHED_V6
+
 -- */
 {
    NTSTATUS status = STATUS_SUCCESS;
@@ -329,6 +355,12 @@ TLInspectRegisterALEClassifyCallouts(
       sCallout.classifyFn = TLInspectALEConnectClassify;
       sCallout.notifyFn = TLInspectALEConnectNotify;
    }
+   else if (IsEqualGUID(layerKey, &FWPM_LAYER_ALE_FLOW_ESTABLISHED_V4) ||
+            IsEqualGUID(layerKey, &FWPM_LAYER_ALE_FLOW_ESTABLISHED_V6))
+   {
+      sCallout.classifyFn = TLInspectALEFlowEstablishedClassify;
+      sCallout.notifyFn = TLInspectALEFlowEstablishedNotify;
+   }
    else
    {
       sCallout.classifyFn = TLInspectALERecvAcceptClassify;
@@ -370,7 +402,8 @@ TLInspectRegisterALEClassifyCallouts(
                L"Transport Inspect ALE Classify",
                L"Intercepts inbound or outbound connect attempts",
                (IsEqualGUID(layerKey, &FWPM_LAYER_ALE_AUTH_CONNECT_V4) ||
-                IsEqualGUID(layerKey, &FWPM_LAYER_ALE_AUTH_RECV_ACCEPT_V4)) ? 
+                IsEqualGUID(layerKey, &FWPM_LAYER_ALE_AUTH_RECV_ACCEPT_V4) ||
+                IsEqualGUID(layerKey, &FWPM_LAYER_ALE_FLOW_ESTABLISHED_V4)) ? 
                   configInspectRemoteAddrV4 : configInspectRemoteAddrV6,
                0,
                layerKey,
@@ -427,6 +460,7 @@ TLInspectRegisterTransportCallouts(
    sCallout.calloutKey = *calloutKey;
    sCallout.classifyFn = TLInspectTransportClassify;
    sCallout.notifyFn = TLInspectTransportNotify;
+   sCallout.flowDeleteFn = TLInspectFlowDelete;
 
    status = FwpsCalloutRegister(
                deviceObject,
@@ -496,7 +530,8 @@ TLInspectRegisterCallouts(
 
    This function registers dynamic callouts and filters that intercept 
    transport traffic at ALE AUTH_CONNECT/AUTH_RECV_ACCEPT and 
-   INBOUND/OUTBOUND transport layers.
+   INBOUND/OUTBOUND transport layers, as well as the ALE FLOW_ESTABLISHED
+   callouts that cache the verdict of authorized flows.
 
    Callouts and filters will be removed during DriverUnload.
 
@@ -595,6 +630,21 @@ TLInspectRegisterCallouts(
       {
          goto Exit;
       }
+
+      //
+      // Registered after the transport callouts, whose IDs it associates
+      // the flow contexts with.
+      //
+      status = TLInspectRegisterALEClassifyCallouts(
+                  &FWPM_LAYER_ALE_FLOW_ESTABLISHED_V4,
+                  &TL_INSPECT_ALE_FLOW_ESTABLISHED_CALLOUT_V4,
+                  deviceObject,
+                  &gAleFlowEstablishedCalloutIdV4
+                  );
+      if (!NT_SUCCESS(status))
+      {
+         goto Exit;
+      }
    }
 
    if (configInspectRemoteAddrV6 != NULL)
@@ -642,6 +692,21 @@ TLInspectRegisterCallouts(
       {
          goto Exit;
       }
+
+      //
+      // Registered after the transport callouts, whose IDs it associates
+      // the flow contexts with.
+      //
+      status = TLInspectRegisterALEClassifyCallouts(
+                  &FWPM_LAYER_ALE_FLOW_ESTABLISHED_V6,
+                  &TL_INSPECT_ALE_FLOW_ESTABLISHED_CALLOUT_V6,
+                  deviceObject,
+                  &gAleFlowEstablishedCalloutIdV6
+                  );
+      if (!NT_SUCCESS(status))
+      {
+         goto Exit;
+      }
    }
 
    status = FwpmTransactionCommit(gEngineHandle);
@@ -676,6 +741,15 @@ TLInspectUnregisterCallouts(void)
    FwpmEngineClose(gEngineHandle);
    gEngineHandle = NULL;
 
+   FwpsCalloutUnregisterById(gAleFlowEstablishedCalloutIdV6);
+   FwpsCalloutUnregisterById(gAleFlowEstablishedCalloutIdV4);
+
+   //
+   // The transport callouts can't be unregistered while flow contexts are
+   // still associated with them.
+   //
+   TLInspectRemoveFlowContexts();
+
    FwpsCalloutUnregisterById(gOutboundTlCalloutIdV6);
    FwpsCalloutUnregisterById(gOutboundTlCalloutIdV4);
    FwpsCalloutUnregisterById(gInboundTlCalloutIdV6);
@@ -687,58 +761,89 @@ TLInspectUnregisterCallouts(void)
    FwpsCalloutUnregisterById(gAleRecvAcceptCalloutIdV4);
 }
 
-_Function_class_(EVT_WDF_DRIVER_UNLOAD)
-_IRQL_requires_same_
-_IRQL_requires_max_(PASSIVE_LEVEL)
 void
-TLInspectEvtDriverUnload(
-   _In_ WDFDRIVER driverObject
-   )
-{
+TLInspectStopWorkers(void)
+/* ++
 
+   Tells the worker threads that the driver is unloading and waits for all 
+   of them to exit. The work queues themselves are freed only after the 
+   callouts are unregistered, since a classify may still look them up.
+
+-- */
+{
    KLOCK_QUEUE_HANDLE connListLockHandle;
    KLOCK_QUEUE_HANDLE packetQueueLockHandle;
-
-   UNREFERENCED_PARAMETER(driverObject);
-
-   KeAcquireInStackQueuedSpinLock(
-      &gConnListLock,
-      &connListLockHandle
-      );
-   KeAcquireInStackQueuedSpinLock(
-      &gPacketQueueLock,
-      &packetQueueLockHandle
-      );
+   TL_INSPECT_WORK_QUEUE* workQueue;
+   ULONG i;
 
    gDriverUnloading = TRUE;
 
-   KeReleaseInStackQueuedSpinLock(&packetQueueLockHandle);
-   KeReleaseInStackQueuedSpinLock(&connListLockHandle);
-
-   if (IsListEmpty(&gConnList) && IsListEmpty(&gPacketQueue))
+   for (i = 0; i < gNumWorkQueues; i++)
    {
+      workQueue = &gWorkQueues[i];
+
+      //
+      // Cycle the queue locks so that a classify that has already checked
+      // gDriverUnloading under them is done queueing before the worker
+      // thread is woken up to drain the queues.
+      //
+      KeAcquireInStackQueuedSpinLock(
+         &workQueue->connListLock,
+         &connListLockHandle
+         );
+      KeAcquireInStackQueuedSpinLock(
+         &workQueue->packetQueueLock,
+         &packetQueueLockHandle
+         );
+
+      KeReleaseInStackQueuedSpinLock(&packetQueueLockHandle);
+      KeReleaseInStackQueuedSpinLock(&connListLockHandle);
+
       KeSetEvent(
-         &gWorkerEvent,
+         &workQueue->workerEvent,
          IO_NO_INCREMENT, 
          FALSE
          );
    }
 
-   NT_ASSERT(gThreadObj != NULL);
+   for (i = 0; i < gNumWorkQueues; i++)
+   {
+      workQueue = &gWorkQueues[i];
+
+      if (workQueue->threadObj != NULL)
+      {
+         KeWaitForSingleObject(
+            workQueue->threadObj,
+            Executive,
+            KernelMode,
+            FALSE,
+            NULL
+            );
+
+         ObDereferenceObject(workQueue->threadObj);
+         workQueue->threadObj = NULL;
+      }
+   }
+}
+
+_Function_class_(EVT_WDF_DRIVER_UNLOAD)
+_IRQL_requires_same_
+_IRQL_requires_max_(PASSIVE_LEVEL)
+void
+TLInspectEvtDriverUnload(
+   _In_ WDFDRIVER driverObject
+   )
+{
 
-   KeWaitForSingleObject(
-      gThreadObj,
-      Executive,
-      KernelMode,
-      FALSE,
-      NULL
-      );
+   UNREFERENCED_PARAMETER(driverObject);
 
-   ObDereferenceObject(gThreadObj);
+   TLInspectStopWorkers();
 
    TLInspectUnregisterCallouts();
 
    FwpsInjectionHandleDestroy(gInjectionHandle);
+
+   ExFreePoolWithTag(gWorkQueues, TL_INSPECT_WORK_QUEUE_POOL_TAG);
 }
 
 NTSTATUS
@@ -806,6 +911,8 @@ DriverEntry(
    WDFDRIVER driver;
    WDFDEVICE device;
    HANDLE threadHandle;
+   TL_INSPECT_WORK_QUEUE* workQueue;
+   ULONG i;
 
    // Request NX Non-Paged Pool when available
    ExInitializeDriverRuntime(DrvRtPoolNxOptIn);
@@ -860,17 +967,47 @@ DriverEntry(
       goto Exit;
    }
 
-   InitializeListHead(&gConnList);
-   KeInitializeSpinLock(&gConnListLock);   
+#if(NTDDI_VERSION >= NTDDI_WIN7)
+   gNumWorkQueues = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+#else
+   gNumWorkQueues = KeQueryActiveProcessorCount(NULL);
+#endif /// (NTDDI_VERSION >= NTDDI_WIN7)
 
-   InitializeListHead(&gPacketQueue);
-   KeInitializeSpinLock(&gPacketQueueLock);  
+   gWorkQueues = ExAllocatePoolWithTag(
+                     NonPagedPool,
+                     gNumWorkQueues * sizeof(TL_INSPECT_WORK_QUEUE),
+                     TL_INSPECT_WORK_QUEUE_POOL_TAG
+                     );
 
-   KeInitializeEvent(
-      &gWorkerEvent,
-      NotificationEvent,
-      FALSE
-      );
+   if (gWorkQueues == NULL)
+   {
+      status = STATUS_INSUFFICIENT_RESOURCES;
+      goto Exit;
+   }
+
+   RtlZeroMemory(gWorkQueues, gNumWorkQueues * sizeof(TL_INSPECT_WORK_QUEUE));
+
+   for (i = 0; i < gNumWorkQueues; i++)
+   {
+      workQueue = &gWorkQueues[i];
+
+      InitializeListHead(&workQueue->connList);
+      KeInitializeSpinLock(&workQueue->connListLock);   
+
+      InitializeListHead(&workQueue->packetQueue);
+      KeInitializeSpinLock(&workQueue->packetQueueLock);  
+
+      KeInitializeEvent(
+         &workQueue->workerEvent,
+         NotificationEvent,
+         FALSE
+         );
+
+      workQueue->processorIndex = i;
+   }
+
+   InitializeListHead(&gFlowContextList);
+   KeInitializeSpinLock(&gFlowContextListLock);
 
    gWdmDevice = WdfDeviceWdmGetDeviceObject(device);
 
@@ -881,37 +1018,46 @@ DriverEntry(
       goto Exit;
    }
 
-   status = PsCreateSystemThread(
-               &threadHandle,
-               THREAD_ALL_ACCESS,
-               NULL,
-               NULL,
-               NULL,
-               TLInspectWorker,
-               NULL
-               );
-
-   if (!NT_SUCCESS(status))
+   for (i = 0; i < gNumWorkQueues; i++)
    {
-      goto Exit;
-   }
+      workQueue = &gWorkQueues[i];
+
+      status = PsCreateSystemThread(
+                  &threadHandle,
+                  THREAD_ALL_ACCESS,
+                  NULL,
+                  NULL,
+                  NULL,
+                  TLInspectWorker,
+                  workQueue
+                  );
 
-   status = ObReferenceObjectByHandle(
-               threadHandle,
-               0,
-               NULL,
-               KernelMode,
-               &gThreadObj,
-               NULL
-               );
-   NT_ASSERT(NT_SUCCESS(status));
+      if (!NT_SUCCESS(status))
+      {
+         goto Exit;
+      }
 
-   ZwClose(threadHandle);
+      status = ObReferenceObjectByHandle(
+                  threadHandle,
+                  0,
+                  NULL,
+                  KernelMode,
+                  &workQueue->threadObj,
+                  NULL
+                  );
+      NT_ASSERT(NT_SUCCESS(status));
+
+      ZwClose(threadHandle);
+   }
 
 Exit:
    
    if (!NT_SUCCESS(status))
    {
+      if (gWorkQueues != NULL)
+      {
+         TLInspectStopWorkers();
+      }
       if (gEngineHandle != NULL)
       {
          TLInspectUnregisterCallouts();
@@ -920,6 +1066,10 @@ Exit:
       {
          FwpsInjectionHandleDestroy(gInjectionHandle);
       }
+      if (gWorkQueues != NULL)
+      {
+         ExFreePoolWithTag(gWorkQueues, TL_INSPECT_WORK_QUEUE_POOL_TAG);
+      }
    }
 
    return status;
@@ -5,12 +5,13 @@ Copyright (c) Microsoft Corporation. All rights reserved
 Abstract:
 
    This file implements the classifyFn callout functions for the ALE connect,
-   recv-accept, and transport callouts. In addition the system worker thread 
-   that performs the actual packet inspection is also implemented here along 
+   recv-accept, and transport callouts. In addition the system worker threads
+   that perform the actual packet inspection are also implemented here along 
    with the eventing mechanisms shared between the classify function and the
-   worker thread.
+   worker threads. Each flow is hashed to one of the per-processor work 
+   queues, each serviced by a worker thread running on that processor.
 
-   connect/Packet inspection is done out-of-band by a system worker thread 
+   connect/Packet inspection is done out-of-band by the system worker threads
    using the reference-drop-clone-reinject as well as ALE pend/complete 
    mechanism. Therefore the sample can serve as a base in scenarios where 
    filtering decision cannot be made within the classifyFn() callout and 
@@ -90,6 +91,7 @@ TLInspectALEConnectClassify(
    ADDRESS_FAMILY addressFamily;
    FWPS_PACKET_INJECTION_STATE packetState;
    BOOLEAN signalWorkerThread;
+   TL_INSPECT_WORK_QUEUE* workQueue;
 
 #if(NTDDI_VERSION >= NTDDI_WIN7)
    UNREFERENCED_PARAMETER(classifyContext);
@@ -131,6 +133,8 @@ TLInspectALEConnectClassify(
 
    addressFamily = GetAddressFamilyForLayer(inFixedValues->layerId);
 
+   workQueue = GetWorkQueueForFlow(inFixedValues, addressFamily);
+
    if (!IsAleReauthorize(inFixedValues))
    {
       //
@@ -173,18 +177,19 @@ TLInspectALEConnectClassify(
       }
 
       KeAcquireInStackQueuedSpinLock(
-         &gConnListLock,
+         &workQueue->connListLock,
          &connListLockHandle
          );
       KeAcquireInStackQueuedSpinLock(
-         &gPacketQueueLock,
+         &workQueue->packetQueueLock,
          &packetQueueLockHandle
          );
 
-      signalWorkerThread = IsListEmpty(&gConnList) && 
-                           IsListEmpty(&gPacketQueue);
+      signalWorkerThread = IsListEmpty(&workQueue->connList) && 
+                           IsListEmpty(&workQueue->packetQueue);
 
-      InsertTailList(&gConnList, &pendedConnect->listEntry);
+      InsertTailList(&workQueue->connList, &pendedConnect->listEntry);
+      workQueue->connListDepth++;
       pendedConnect = NULL; // ownership transferred
 
       KeReleaseInStackQueuedSpinLock(&packetQueueLockHandle);
@@ -197,7 +202,7 @@ TLInspectALEConnectClassify(
       if (signalWorkerThread)
       {
          KeSetEvent(
-            &gWorkerEvent, 
+            &workQueue->workerEvent, 
             0, 
             FALSE
             );
@@ -235,12 +240,12 @@ TLInspectALEConnectClassify(
          //
 
          KeAcquireInStackQueuedSpinLock(
-            &gConnListLock,
+            &workQueue->connListLock,
             &connListLockHandle
             );
 
-         for (listEntry = gConnList.Flink;
-              listEntry != &gConnList;
+         for (listEntry = workQueue->connList.Flink;
+              listEntry != &workQueue->connList;
               listEntry = listEntry->Flink)
          {
             connEntry = CONTAINING_RECORD(
@@ -270,6 +275,7 @@ TLInspectALEConnectClassify(
                }
 
                RemoveEntryList(&pendedConnect->listEntry);
+               workQueue->connListDepth--;
                
                if (!gDriverUnloading &&
                    (pendedConnect->netBufferList != NULL) &&
@@ -284,14 +290,15 @@ TLInspectALEConnectClassify(
                   pendedConnect->type = TL_INSPECT_DATA_PACKET;
 
                   KeAcquireInStackQueuedSpinLock(
-                     &gPacketQueueLock,
+                     &workQueue->packetQueueLock,
                      &packetQueueLockHandle
                      );
 
-                  signalWorkerThread = IsListEmpty(&gPacketQueue) &&
-                                       IsListEmpty(&gConnList);
+                  signalWorkerThread = IsListEmpty(&workQueue->packetQueue) &&
+                                       IsListEmpty(&workQueue->connList);
 
-                  InsertTailList(&gPacketQueue, &pendedConnect->listEntry);
+                  InsertTailList(&workQueue->packetQueue, &pendedConnect->listEntry);
+                  IncrementPacketQueueDepth(workQueue);
                   pendedConnect = NULL; // ownership transferred
 
                   KeReleaseInStackQueuedSpinLock(&packetQueueLockHandle);
@@ -299,7 +306,7 @@ TLInspectALEConnectClassify(
                   if (signalWorkerThread)
                   {
                      KeSetEvent(
-                        &gWorkerEvent, 
+                        &workQueue->workerEvent, 
                         0, 
                         FALSE
                         );
@@ -350,20 +357,21 @@ TLInspectALEConnectClassify(
       }
 
       KeAcquireInStackQueuedSpinLock(
-         &gConnListLock,
+         &workQueue->connListLock,
          &connListLockHandle
          );
       KeAcquireInStackQueuedSpinLock(
-         &gPacketQueueLock,
+         &workQueue->packetQueueLock,
          &packetQueueLockHandle
          );
 
       if (!gDriverUnloading)
       {
-         signalWorkerThread = IsListEmpty(&gPacketQueue) &&
-                              IsListEmpty(&gConnList);
+         signalWorkerThread = IsListEmpty(&workQueue->packetQueue) &&
+                              IsListEmpty(&workQueue->connList);
 
-         InsertTailList(&gPacketQueue, &pendedPacket->listEntry);
+         InsertTailList(&workQueue->packetQueue, &pendedPacket->listEntry);
+         IncrementPacketQueueDepth(workQueue);
          pendedPacket = NULL; // ownership transferred
 
          classifyOut->actionType = FWP_ACTION_BLOCK;
@@ -390,7 +398,7 @@ TLInspectALEConnectClassify(
       if (signalWorkerThread)
       {
          KeSetEvent(
-            &gWorkerEvent, 
+            &workQueue->workerEvent, 
             0, 
             FALSE
             );
@@ -459,6 +467,7 @@ TLInspectALERecvAcceptClassify(
    ADDRESS_FAMILY addressFamily;
    FWPS_PACKET_INJECTION_STATE packetState;
    BOOLEAN signalWorkerThread;
+   TL_INSPECT_WORK_QUEUE* workQueue;
 
 #if(NTDDI_VERSION >= NTDDI_WIN7)
    UNREFERENCED_PARAMETER(classifyContext);
@@ -500,6 +509,8 @@ TLInspectALERecvAcceptClassify(
 
    addressFamily = GetAddressFamilyForLayer(inFixedValues->layerId);
 
+   workQueue = GetWorkQueueForFlow(inFixedValues, addressFamily);
+
    if (!IsAleReauthorize(inFixedValues))
    {
       //
@@ -542,18 +553,19 @@ TLInspectALERecvAcceptClassify(
       }
 
       KeAcquireInStackQueuedSpinLock(
-         &gConnListLock,
+         &workQueue->connListLock,
          &connListLockHandle
          );
       KeAcquireInStackQueuedSpinLock(
-         &gPacketQueueLock,
+         &workQueue->packetQueueLock,
          &packetQueueLockHandle
          );
 
-      signalWorkerThread = IsListEmpty(&gConnList) && 
-                           IsListEmpty(&gPacketQueue);
+      signalWorkerThread = IsListEmpty(&workQueue->connList) && 
+                           IsListEmpty(&workQueue->packetQueue);
 
-      InsertTailList(&gConnList, &pendedRecvAccept->listEntry);
+      InsertTailList(&workQueue->connList, &pendedRecvAccept->listEntry);
+      workQueue->connListDepth++;
       pendedRecvAccept = NULL; // ownership transferred
 
       KeReleaseInStackQueuedSpinLock(&packetQueueLockHandle);
@@ -566,7 +578,7 @@ TLInspectALERecvAcceptClassify(
       if (signalWorkerThread)
       {
          KeSetEvent(
-            &gWorkerEvent, 
+            &workQueue->workerEvent, 
             0, 
             FALSE
             );
@@ -612,20 +624,21 @@ TLInspectALERecvAcceptClassify(
       }
 
       KeAcquireInStackQueuedSpinLock(
-         &gConnListLock,
+         &workQueue->connListLock,
          &connListLockHandle
          );
       KeAcquireInStackQueuedSpinLock(
-         &gPacketQueueLock,
+         &workQueue->packetQueueLock,
          &packetQueueLockHandle
          );
 
       if (!gDriverUnloading)
       {
-         signalWorkerThread = IsListEmpty(&gPacketQueue) &&
-                              IsListEmpty(&gConnList);
+         signalWorkerThread = IsListEmpty(&workQueue->packetQueue) &&
+                              IsListEmpty(&workQueue->connList);
 
-         InsertTailList(&gPacketQueue, &pendedPacket->listEntry);
+         InsertTailList(&workQueue->packetQueue, &pendedPacket->listEntry);
+         IncrementPacketQueueDepth(workQueue);
          pendedPacket = NULL; // ownership transferred
 
          classifyOut->actionType = FWP_ACTION_BLOCK;
@@ -652,7 +665,7 @@ TLInspectALERecvAcceptClassify(
       if (signalWorkerThread)
       {
          KeSetEvent(
-            &gWorkerEvent, 
+            &workQueue->workerEvent, 
             0, 
             FALSE
             );
@@ -717,12 +730,12 @@ TLInspectTransportClassify(
    ADDRESS_FAMILY addressFamily;
    FWPS_PACKET_INJECTION_STATE packetState;
    BOOLEAN signalWorkerThread;
+   TL_INSPECT_WORK_QUEUE* workQueue;
 
 #if(NTDDI_VERSION >= NTDDI_WIN7)
    UNREFERENCED_PARAMETER(classifyContext);
 #endif /// (NTDDI_VERSION >= NTDDI_WIN7)
    UNREFERENCED_PARAMETER(filter);
-   UNREFERENCED_PARAMETER(flowContext);
 
    //
    // We don't have the necessary right to alter the classify, exit.
@@ -756,8 +769,31 @@ TLInspectTransportClassify(
       goto Exit;
    }
 
+   if (flowContext != 0)
+   {
+      TL_INSPECT_FLOW_CONTEXT* flowCtx = 
+         (TL_INSPECT_FLOW_CONTEXT*)(ULONG_PTR)flowContext;
+
+      //
+      // The flow has been authorized already and the verdict still holds, 
+      // permit the packet inline instead of pending it.
+      //
+      if ((flowCtx->verdict == FWP_ACTION_PERMIT) &&
+          (flowCtx->verdictGeneration == gVerdictGeneration))
+      {
+         classifyOut->actionType = FWP_ACTION_PERMIT;
+         if (filter->flags & FWPS_FILTER_FLAG_CLEAR_ACTION_RIGHT)
+         {
+            classifyOut->rights &= ~FWPS_RIGHT_ACTION_WRITE;
+         }
+         goto Exit;
+      }
+   }
+
    addressFamily = GetAddressFamilyForLayer(inFixedValues->layerId);
 
+   workQueue = GetWorkQueueForFlow(inFixedValues, addressFamily);
+
    packetDirection = 
       GetPacketDirectionForLayer(inFixedValues->layerId);
 
@@ -821,20 +857,21 @@ TLInspectTransportClassify(
    }
 
    KeAcquireInStackQueuedSpinLock(
-      &gConnListLock,
+      &workQueue->connListLock,
       &connListLockHandle
       );
    KeAcquireInStackQueuedSpinLock(
-      &gPacketQueueLock,
+      &workQueue->packetQueueLock,
       &packetQueueLockHandle
       );
 
    if (!gDriverUnloading)
    {
-      signalWorkerThread = IsListEmpty(&gPacketQueue) &&
-                           IsListEmpty(&gConnList);
+      signalWorkerThread = IsListEmpty(&workQueue->packetQueue) &&
+                           IsListEmpty(&workQueue->connList);
 
-      InsertTailList(&gPacketQueue, &pendedPacket->listEntry);
+      InsertTailList(&workQueue->packetQueue, &pendedPacket->listEntry);
+      IncrementPacketQueueDepth(workQueue);
       pendedPacket = NULL; // ownership transferred
 
       classifyOut->actionType = FWP_ACTION_BLOCK;
@@ -861,7 +898,7 @@ TLInspectTransportClassify(
    if (signalWorkerThread)
    {
       KeSetEvent(
-         &gWorkerEvent, 
+         &workQueue->workerEvent, 
          0, 
          FALSE
          );
@@ -919,6 +956,293 @@ TLInspectTransportNotify(
    return STATUS_SUCCESS;
 }
 
+#if(NTDDI_VERSION >= NTDDI_WIN7)
+
+void
+TLInspectALEFlowEstablishedClassify(
+   _In_ const FWPS_INCOMING_VALUES* inFixedValues,
+   _In_ const FWPS_INCOMING_METADATA_VALUES* inMetaValues,
+   _Inout_opt_ void* layerData,
+   _In_opt_ const void* classifyContext,
+   _In_ const FWPS_FILTER* filter,
+   _In_ UINT64 flowContext,
+   _Inout_ FWPS_CLASSIFY_OUT* classifyOut
+   )
+
+#else
+
+void
+TLInspectALEFlowEstablishedClassify(
+   _In_ const FWPS_INCOMING_VALUES* inFixedValues,
+   _In_ const FWPS_INCOMING_METADATA_VALUES* inMetaValues,
+   _Inout_opt_ void* layerData,
+   _In_ const FWPS_FILTER* filter,
+   _In_ UINT64 flowContext,
+   _Inout_ FWPS_CLASSIFY_OUT* classifyOut
+   )
+
+#endif /// (NTDDI_VERSION >= NTDDI_WIN7)
+/* ++
+
+   This is the classifyFn function for the ALE Flow-Established (v4 and v6)
+   callout. A flow only gets established once its connect or recv-accept 
+   has been permitted, so the verdict of the inspection is recorded in a 
+   flow context associated with the flow for both transport callouts. The 
+   transport classifyFn then permits the packets of the flow inline.
+
+-- */
+{
+   NTSTATUS status;
+
+   KLOCK_QUEUE_HANDLE flowContextListLockHandle;
+
+   TL_INSPECT_FLOW_CONTEXT* flowCtx;
+   UINT16 layerIds[2];
+   UINT32 calloutIds[2];
+   LONG verdictGeneration;
+   UINT i;
+
+#if(NTDDI_VERSION >= NTDDI_WIN7)
+   UNREFERENCED_PARAMETER(classifyContext);
+#endif /// (NTDDI_VERSION >= NTDDI_WIN7)
+   UNREFERENCED_PARAMETER(layerData);
+   UNREFERENCED_PARAMETER(flowContext);
+
+   if ((classifyOut->rights & FWPS_RIGHT_ACTION_WRITE) == 0)
+   {
+      goto Exit;
+   }
+
+   classifyOut->actionType = FWP_ACTION_PERMIT;
+   if (filter->flags & FWPS_FILTER_FLAG_CLEAR_ACTION_RIGHT)
+   {
+      classifyOut->rights &= ~FWPS_RIGHT_ACTION_WRITE;
+   }
+
+   //
+   // Capture the generation before looking at the setting, so a verdict 
+   // cached under a setting that has just changed is already stale.
+   //
+   verdictGeneration = InterlockedCompareExchange(&gVerdictGeneration, 0, 0);
+
+   if (!configPermitTraffic ||
+       !FWPS_IS_METADATA_FIELD_PRESENT(inMetaValues, 
+                                       FWPS_METADATA_FIELD_FLOW_HANDLE))
+   {
+      goto Exit;
+   }
+
+   if (inFixedValues->layerId == FWPS_LAYER_ALE_FLOW_ESTABLISHED_V4)
+   {
+      layerIds[0] = FWPS_LAYER_OUTBOUND_TRANSPORT_V4;
+      calloutIds[0] = gOutboundTlCalloutIdV4;
+      layerIds[1] = FWPS_LAYER_INBOUND_TRANSPORT_V4;
+      calloutIds[1] = gInboundTlCalloutIdV4;
+   }
+   else
+   {
+      layerIds[0] = FWPS_LAYER_OUTBOUND_TRANSPORT_V6;
+      calloutIds[0] = gOutboundTlCalloutIdV6;
+      layerIds[1] = FWPS_LAYER_INBOUND_TRANSPORT_V6;
+      calloutIds[1] = gInboundTlCalloutIdV6;
+   }
+
+   for (i = 0; i < RTL_NUMBER_OF(layerIds); i++)
+   {
+      flowCtx = ExAllocatePoolWithTag(
+                     NonPagedPool,
+                     sizeof(TL_INSPECT_FLOW_CONTEXT),
+                     TL_INSPECT_CONNECTION_POOL_TAG
+                     );
+
+      if (flowCtx == NULL)
+      {
+         //
+         // Without a flow context the packets of the flow are simply 
+         // inspected out-of-band like before.
+         //
+         continue;
+      }
+
+      RtlZeroMemory(flowCtx, sizeof(TL_INSPECT_FLOW_CONTEXT));
+
+      flowCtx->flowHandle = inMetaValues->flowHandle;
+      flowCtx->layerId = layerIds[i];
+      flowCtx->calloutId = calloutIds[i];
+      flowCtx->verdict = FWP_ACTION_PERMIT;
+      flowCtx->verdictGeneration = verdictGeneration;
+
+      //
+      // The flow context is put on the list before it is associated such 
+      // that the flowDeleteFn can always find it there.
+      //
+      KeAcquireInStackQueuedSpinLock(
+         &gFlowContextListLock,
+         &flowContextListLockHandle
+         );
+
+      if (gDriverUnloading)
+      {
+         KeReleaseInStackQueuedSpinLock(&flowContextListLockHandle);
+         ExFreePoolWithTag(flowCtx, TL_INSPECT_CONNECTION_POOL_TAG);
+         break;
+      }
+
+      InsertTailList(&gFlowContextList, &flowCtx->listEntry);
+
+      KeReleaseInStackQueuedSpinLock(&flowContextListLockHandle);
+
+      status = FwpsFlowAssociateContext(
+                  flowCtx->flowHandle,
+                  flowCtx->layerId,
+                  flowCtx->calloutId,
+                  (UINT64)(ULONG_PTR)flowCtx
+                  );
+
+      if (!NT_SUCCESS(status))
+      {
+         KeAcquireInStackQueuedSpinLock(
+            &gFlowContextListLock,
+            &flowContextListLockHandle
+            );
+
+         RemoveEntryList(&flowCtx->listEntry);
+
+         KeReleaseInStackQueuedSpinLock(&flowContextListLockHandle);
+
+         ExFreePoolWithTag(flowCtx, TL_INSPECT_CONNECTION_POOL_TAG);
+      }
+   }
+
+Exit:
+
+   return;
+}
+
+NTSTATUS
+TLInspectALEFlowEstablishedNotify(
+   _In_ FWPS_CALLOUT_NOTIFY_TYPE notifyType,
+   _In_ const GUID* filterKey,
+   _Inout_ const FWPS_FILTER* filter
+   )
+{
+   UNREFERENCED_PARAMETER(notifyType);
+   UNREFERENCED_PARAMETER(filterKey);
+   UNREFERENCED_PARAMETER(filter);
+
+   return STATUS_SUCCESS;
+}
+
+void
+NTAPI
+TLInspectFlowDelete(
+   _In_ UINT16 layerId,
+   _In_ UINT32 calloutId,
+   _In_ UINT64 flowContext
+   )
+/* ++
+
+   This is the flowDeleteFn function for the transport callouts. It is 
+   called when a flow with an associated flow context goes away, or when
+   the flow context is removed during driver unload.
+
+-- */
+{
+   KLOCK_QUEUE_HANDLE flowContextListLockHandle;
+
+   TL_INSPECT_FLOW_CONTEXT* flowCtx = 
+      (TL_INSPECT_FLOW_CONTEXT*)(ULONG_PTR)flowContext;
+
+   UNREFERENCED_PARAMETER(layerId);
+   UNREFERENCED_PARAMETER(calloutId);
+
+   KeAcquireInStackQueuedSpinLock(
+      &gFlowContextListLock,
+      &flowContextListLockHandle
+      );
+
+   RemoveEntryList(&flowCtx->listEntry);
+
+   KeReleaseInStackQueuedSpinLock(&flowContextListLockHandle);
+
+   ExFreePoolWithTag(flowCtx, TL_INSPECT_CONNECTION_POOL_TAG);
+}
+
+void
+TLInspectRemoveFlowContexts(void)
+/* ++
+
+   This function removes all the flow contexts from their flows before the
+   transport callouts are unregistered. Each removal results in a call to
+   TLInspectFlowDelete, which frees the flow context.
+
+-- */
+{
+   KLOCK_QUEUE_HANDLE flowContextListLockHandle;
+
+   TL_INSPECT_FLOW_CONTEXT* flowCtx;
+   LIST_ENTRY* listEntry;
+   UINT64 flowHandle;
+   UINT16 layerId;
+   UINT32 calloutId;
+
+   NT_ASSERT(gDriverUnloading);
+
+   for(;;)
+   {
+      flowCtx = NULL;
+
+      KeAcquireInStackQueuedSpinLock(
+         &gFlowContextListLock,
+         &flowContextListLockHandle
+         );
+
+      for (listEntry = gFlowContextList.Flink;
+           listEntry != &gFlowContextList;
+           listEntry = listEntry->Flink)
+      {
+         flowCtx = CONTAINING_RECORD(
+                        listEntry,
+                        TL_INSPECT_FLOW_CONTEXT,
+                        listEntry
+                        );
+
+         if (!flowCtx->removing)
+         {
+            break;
+         }
+
+         flowCtx = NULL;
+      }
+
+      if (flowCtx != NULL)
+      {
+         flowCtx->removing = TRUE;
+
+         flowHandle = flowCtx->flowHandle;
+         layerId = flowCtx->layerId;
+         calloutId = flowCtx->calloutId;
+      }
+
+      KeReleaseInStackQueuedSpinLock(&flowContextListLockHandle);
+
+      if (flowCtx == NULL)
+      {
+         break;
+      }
+
+      //
+      // The flow context may be freed by a concurrent flow deletion as soon
+      // as the lock is released, so only the copied values are used here.
+      //
+      FwpsFlowRemoveContext(
+         flowHandle,
+         layerId,
+         calloutId
+         );
+   }
+}
+
 void TLInspectInjectComplete(
    _Inout_ void* context,
    _Inout_ NET_BUFFER_LIST* netBufferList,
@@ -1208,37 +1532,106 @@ TlInspectCompletePendedConnection(
    }
 }
 
+void
+TlInspectProcessPendedPacket(
+   _Inout_ __drv_freesMem(Mem) TL_INSPECT_PENDED_PACKET* packet
+   )
+/* ++
+
+   This function completes a pended connection and/or clone-reinjects a 
+   pended packet according to the current inspection result. The pended 
+   packet is freed unless its ownership is transferred.
+
+-- */
+{
+   NTSTATUS status;
+
+   if (packet->type == TL_INSPECT_CONNECT_PACKET)
+   {
+      TlInspectCompletePendedConnection(
+         &packet,
+         configPermitTraffic);
+   }
+
+   if ((packet != NULL) && configPermitTraffic)
+   {
+      if (packet->direction == FWP_DIRECTION_OUTBOUND)
+      {
+         status = TLInspectCloneReinjectOutbound(packet);
+      }
+      else
+      {
+         status = TLInspectCloneReinjectInbound(packet);
+      }
+
+      if (NT_SUCCESS(status))
+      {
+         packet = NULL; // ownership transferred.
+      }
+
+   }
+
+   if (packet != NULL)
+   {
+      FreePendedPacket(packet);
+   }
+}
+
 void
 TLInspectWorker(
    _In_ void* StartContext
    )
 /* ++
 
-   This worker thread waits for the connect and packet queue event when the 
-   queues are empty; and it will be woken up when there are connects/packets 
-   queued needing to be inspected. Once awaking, It will run in a loop to 
-   complete the pended ALE classifies and/or clone-reinject packets back 
-   until both queues are exhausted (and it will go to sleep waiting for more 
-   work).
+   There is one worker thread per work queue, running on the processor the
+   work queue belongs to. It waits for the work queue event when the queues
+   are empty; and it will be woken up when there are connects/packets queued
+   needing to be inspected. Once awaking, It will run in a loop to complete 
+   the pended ALE classifies and clone-reinject packets back until both 
+   queues are exhausted (and it will go to sleep waiting for more work).
+   Each time around the loop it takes all the packets queued so far off the
+   packet queue at once, so the queue lock is taken once per batch rather 
+   than once per packet.
 
    The worker thread will end once it detected the driver is unloading.
 
 -- */
 {
-   NTSTATUS status;
-
+   TL_INSPECT_WORK_QUEUE* workQueue = (TL_INSPECT_WORK_QUEUE*)StartContext;
    TL_INSPECT_PENDED_PACKET* packet = NULL;
    LIST_ENTRY* listEntry;
+   LIST_ENTRY packetBatch;
+   BOOLEAN permitTraffic;
 
    KLOCK_QUEUE_HANDLE packetQueueLockHandle;
    KLOCK_QUEUE_HANDLE connListLockHandle;
 
-   UNREFERENCED_PARAMETER(StartContext);
+#if(NTDDI_VERSION >= NTDDI_WIN7)
+   NTSTATUS status;
+   PROCESSOR_NUMBER processorNumber;
+   GROUP_AFFINITY affinity;
+
+   status = KeGetProcessorNumberFromIndex(
+               workQueue->processorIndex,
+               &processorNumber
+               );
+
+   if (NT_SUCCESS(status))
+   {
+      RtlZeroMemory(&affinity, sizeof(affinity));
+      affinity.Group = processorNumber.Group;
+      affinity.Mask = AFFINITY_MASK(processorNumber.Number);
+
+      KeSetSystemGroupAffinityThread(&affinity, NULL);
+   }
+#else
+   KeSetSystemAffinityThread(AFFINITY_MASK(workQueue->processorIndex));
+#endif /// (NTDDI_VERSION >= NTDDI_WIN7)
 
    for(;;)
    {
       KeWaitForSingleObject(
-         &gWorkerEvent,
+         &workQueue->workerEvent,
          Executive, 
          KernelMode, 
          FALSE, 
@@ -1250,19 +1643,31 @@ TLInspectWorker(
          break;
       }
 
-      configPermitTraffic = IsTrafficPermitted();
+      permitTraffic = IsTrafficPermitted();
+
+      if (permitTraffic != configPermitTraffic)
+      {
+         //
+         // The verdicts cached in the flow contexts were made under the old
+         // setting, so they may no longer be used. The setting is updated
+         // before the generation; TLInspectALEFlowEstablishedClassify reads
+         // them in the opposite order.
+         //
+         configPermitTraffic = permitTraffic;
+         InterlockedIncrement(&gVerdictGeneration);
+      }
 
-      listEntry = NULL;
+      packet = NULL;
 
       KeAcquireInStackQueuedSpinLock(
-         &gConnListLock,
+         &workQueue->connListLock,
          &connListLockHandle
          );
 
-      if (!IsListEmpty(&gConnList))
+      if (!IsListEmpty(&workQueue->connList))
       {
-         _Analysis_assume_(gConnList.Flink != NULL);
-         listEntry = gConnList.Flink;
+         _Analysis_assume_(workQueue->connList.Flink != NULL);
+         listEntry = workQueue->connList.Flink;
 
          packet = CONTAINING_RECORD(
                            listEntry,
@@ -1272,6 +1677,7 @@ TLInspectWorker(
          if (packet->direction == FWP_DIRECTION_INBOUND)
          {
             RemoveEntryList(&packet->listEntry);
+            workQueue->connListDepth--;
          }
 
          //
@@ -1282,69 +1688,61 @@ TLInspectWorker(
 
       KeReleaseInStackQueuedSpinLock(&connListLockHandle);
 
-      if (listEntry == NULL)
+      if (packet != NULL)
       {
-         NT_ASSERT(!IsListEmpty(&gPacketQueue));
+         TlInspectProcessPendedPacket(packet);
+      }
 
-         KeAcquireInStackQueuedSpinLock(
-            &gPacketQueueLock,
-            &packetQueueLockHandle
-            );
+      //
+      // Take the whole packet queue as one batch.
+      //
+      InitializeListHead(&packetBatch);
 
-         listEntry = RemoveHeadList(&gPacketQueue);
+      KeAcquireInStackQueuedSpinLock(
+         &workQueue->packetQueueLock,
+         &packetQueueLockHandle
+         );
 
-         packet = CONTAINING_RECORD(
-                           listEntry,
-                           TL_INSPECT_PENDED_PACKET,
-                           listEntry
-                           );
+      if (!IsListEmpty(&workQueue->packetQueue))
+      {
+         packetBatch.Flink = workQueue->packetQueue.Flink;
+         packetBatch.Blink = workQueue->packetQueue.Blink;
+         packetBatch.Flink->Blink = &packetBatch;
+         packetBatch.Blink->Flink = &packetBatch;
 
-         KeReleaseInStackQueuedSpinLock(&packetQueueLockHandle);
+         InitializeListHead(&workQueue->packetQueue);
+         workQueue->packetQueueDepth = 0;
       }
 
-      if (packet->type == TL_INSPECT_CONNECT_PACKET)
-      {
-         TlInspectCompletePendedConnection(
-            &packet,
-            configPermitTraffic);
-      }
+      KeReleaseInStackQueuedSpinLock(&packetQueueLockHandle);
 
-      if ((packet != NULL) && configPermitTraffic)
+      while (!IsListEmpty(&packetBatch))
       {
-         if (packet->direction == FWP_DIRECTION_OUTBOUND)
-         {
-            status = TLInspectCloneReinjectOutbound(packet);
-         }
-         else
-         {
-            status = TLInspectCloneReinjectInbound(packet);
-         }
+         listEntry = RemoveHeadList(&packetBatch);
 
-         if (NT_SUCCESS(status))
-         {
-            packet = NULL; // ownership transferred.
-         }
-
-      }
+         packet = CONTAINING_RECORD(
+                           listEntry,
+                           TL_INSPECT_PENDED_PACKET,
+                           listEntry
+                           );
 
-      if (packet != NULL)
-      {
-         FreePendedPacket(packet);
+         TlInspectProcessPendedPacket(packet);
       }
 
       KeAcquireInStackQueuedSpinLock(
-         &gConnListLock,
+         &workQueue->connListLock,
          &connListLockHandle
          );
       KeAcquireInStackQueuedSpinLock(
-         &gPacketQueueLock,
+         &workQueue->packetQueueLock,
          &packetQueueLockHandle
          );
 
-      if (IsListEmpty(&gConnList) && IsListEmpty(&gPacketQueue) &&
+      if (IsListEmpty(&workQueue->connList) && 
+          IsListEmpty(&workQueue->packetQueue) &&
           !gDriverUnloading)
       {
-         KeClearEvent(&gWorkerEvent);
+         KeClearEvent(&workQueue->workerEvent);
       }
 
       KeReleaseInStackQueuedSpinLock(&packetQueueLockHandle);
@@ -1353,18 +1751,18 @@ TLInspectWorker(
 
    NT_ASSERT(gDriverUnloading);
 
-   while (!IsListEmpty(&gConnList))
+   while (!IsListEmpty(&workQueue->connList))
    {
       packet = NULL;
 
       KeAcquireInStackQueuedSpinLock(
-         &gConnListLock,
+         &workQueue->connListLock,
          &connListLockHandle
          );
 
-      if (!IsListEmpty(&gConnList))
+      if (!IsListEmpty(&workQueue->connList))
       {
-         listEntry = gConnList.Flink;
+         listEntry = workQueue->connList.Flink;
          packet = CONTAINING_RECORD(
                            listEntry,
                            TL_INSPECT_PENDED_PACKET,
@@ -1385,18 +1783,19 @@ TLInspectWorker(
    // Discard all the pended packets if driver is being unloaded.
    //
 
-   while (!IsListEmpty(&gPacketQueue))
+   while (!IsListEmpty(&workQueue->packetQueue))
    {
       packet = NULL;
 
       KeAcquireInStackQueuedSpinLock(
-         &gPacketQueueLock,
+         &workQueue->packetQueueLock,
          &packetQueueLockHandle
          );
 
-      if (!IsListEmpty(&gPacketQueue))
+      if (!IsListEmpty(&workQueue->packetQueue))
       {
-         listEntry = RemoveHeadList(&gPacketQueue);
+         listEntry = RemoveHeadList(&workQueue->packetQueue);
+         workQueue->packetQueueDepth--;
 
          packet = CONTAINING_RECORD(
                            listEntry,
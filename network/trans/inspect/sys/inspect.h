@@ -91,27 +91,85 @@ typedef struct TL_INSPECT_PENDED_PACKET_
 
 #pragma warning(pop)
 
+//
+// TL_INSPECT_WORK_QUEUE holds the pended connections and packets of the flows
+// hashed to it. There is one work queue per processor, each serviced by its
+// own worker thread affinitized to that processor, so that a given flow is
+// always inspected and re-injected on the same processor.
+//
+typedef struct TL_INSPECT_WORK_QUEUE_
+{
+   LIST_ENTRY connList;
+   KSPIN_LOCK connListLock;
+
+   LIST_ENTRY packetQueue;
+   KSPIN_LOCK packetQueueLock;
+
+   //
+   // Queue depths, and the deepest the packet queue has been. These are
+   // updated under the corresponding lock and are kept for diagnostics.
+   //
+   LONG connListDepth;
+   LONG packetQueueDepth;
+   LONG packetQueuePeakDepth;
+
+   KEVENT workerEvent;
+
+   void* threadObj;
+   ULONG processorIndex;
+} TL_INSPECT_WORK_QUEUE;
+
+//
+// TL_INSPECT_FLOW_CONTEXT caches the inspection verdict of an established
+// flow. One is associated with the flow for each of the transport callouts,
+// so packets of an already authorized flow can be permitted inline from the
+// classifyFn instead of being cloned and re-injected by a worker thread. The
+// cached verdict is only used while verdictGeneration matches 
+// gVerdictGeneration, which is bumped whenever the PermitTraffic setting 
+// changes.
+//
+typedef struct TL_INSPECT_FLOW_CONTEXT_
+{
+   LIST_ENTRY listEntry;
+
+   UINT64 flowHandle;
+   UINT16 layerId;
+   UINT32 calloutId;
+
+   UINT32 verdict;
+   LONG verdictGeneration;
+
+   //
+   // Set once FwpsFlowRemoveContext has been called for the flow context
+   // during driver unload.
+   //
+   BOOLEAN removing;
+} TL_INSPECT_FLOW_CONTEXT;
+
 //
 // Pooltags used by this callout driver.
 //
 #define TL_INSPECT_CONNECTION_POOL_TAG 'olfD'
 #define TL_INSPECT_PENDED_PACKET_POOL_TAG 'kppD'
 #define TL_INSPECT_CONTROL_DATA_POOL_TAG 'dcdD'
+#define TL_INSPECT_WORK_QUEUE_POOL_TAG 'qwkD'
 
 //
 // Shared global data.
 //
 extern BOOLEAN configPermitTraffic;
+extern LONG gVerdictGeneration;
 
 extern HANDLE gInjectionHandle;
 
-extern LIST_ENTRY gConnList;
-extern KSPIN_LOCK gConnListLock;
+extern TL_INSPECT_WORK_QUEUE* gWorkQueues;
+extern ULONG gNumWorkQueues;
 
-extern LIST_ENTRY gPacketQueue;
-extern KSPIN_LOCK gPacketQueueLock;
+extern LIST_ENTRY gFlowContextList;
+extern KSPIN_LOCK gFlowContextListLock;
 
-extern KEVENT gWorkerEvent;
+extern UINT32 gOutboundTlCalloutIdV4, gInboundTlCalloutIdV4;
+extern UINT32 gOutboundTlCalloutIdV6, gInboundTlCalloutIdV6;
 
 extern BOOLEAN gDriverUnloading;
 
@@ -154,6 +212,17 @@ TLInspectTransportClassify(
    _Inout_ FWPS_CLASSIFY_OUT* classifyOut
    );
 
+void
+TLInspectALEFlowEstablishedClassify(
+   _In_ const FWPS_INCOMING_VALUES* inFixedValues,
+   _In_ const FWPS_INCOMING_METADATA_VALUES* inMetaValues,
+   _Inout_opt_ void* layerData,
+   _In_opt_ const void* classifyContext,
+   _In_ const FWPS_FILTER* filter,
+   _In_ UINT64 flowContext,
+   _Inout_ FWPS_CLASSIFY_OUT* classifyOut
+   );
+
 #else /// (NTDDI_VERSION >= NTDDI_WIN7)
 
 void
@@ -186,6 +255,16 @@ TLInspectTransportClassify(
    _Inout_ FWPS_CLASSIFY_OUT* classifyOut
    );
 
+void
+TLInspectALEFlowEstablishedClassify(
+   _In_ const FWPS_INCOMING_VALUES* inFixedValues,
+   _In_ const FWPS_INCOMING_METADATA_VALUES* inMetaValues,
+   _Inout_opt_ void* layerData,
+   _In_ const FWPS_FILTER* filter,
+   _In_ UINT64 flowContext,
+   _Inout_ FWPS_CLASSIFY_OUT* classifyOut
+   );
+
 #endif /// (NTDDI_VERSION >= NTDDI_WIN7)
 
 NTSTATUS
@@ -209,6 +288,24 @@ TLInspectTransportNotify(
    _Inout_ const FWPS_FILTER* filter
    );
 
+NTSTATUS
+TLInspectALEFlowEstablishedNotify(
+   _In_ FWPS_CALLOUT_NOTIFY_TYPE notifyType,
+   _In_ const GUID* filterKey,
+   _Inout_ const FWPS_FILTER* filter
+   );
+
+void
+NTAPI
+TLInspectFlowDelete(
+   _In_ UINT16 layerId,
+   _In_ UINT32 calloutId,
+   _In_ UINT64 flowContext
+   );
+
+void
+TLInspectRemoveFlowContexts(void);
+
 KSTART_ROUTINE TLInspectWorker;
 
 #endif // _TL_INSPECT_H_
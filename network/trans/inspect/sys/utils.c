@@ -254,6 +254,72 @@ FillNetwork5Tuple(
    return;
 }
 
+TL_INSPECT_WORK_QUEUE*
+GetWorkQueueForFlow(
+   _In_ const FWPS_INCOMING_VALUES* inFixedValues,
+   _In_ ADDRESS_FAMILY addressFamily
+   )
+/* ++
+
+   Returns the work queue for the flow of the classify by hashing its 
+   5-tuple. Local and remote are the same for both directions of a flow, 
+   so all the connects and packets of a flow land on the same work queue.
+
+-- */
+{
+   UINT localAddrIndex;
+   UINT remoteAddrIndex;
+   UINT localPortIndex;
+   UINT remotePortIndex;
+   UINT protocolIndex;
+   UINT32 hash = 2166136261; // FNV-1a offset basis
+   UINT i;
+
+   GetNetwork5TupleIndexesForLayer(
+      inFixedValues->layerId,
+      &localAddrIndex,
+      &remoteAddrIndex,
+      &localPortIndex,
+      &remotePortIndex,
+      &protocolIndex
+      );
+
+   if (localAddrIndex == UINT_MAX)
+   {
+      return &gWorkQueues[0];
+   }
+
+   if (addressFamily == AF_INET)
+   {
+      hash = (hash ^ 
+         inFixedValues->incomingValue[localAddrIndex].value.uint32) * 16777619;
+      hash = (hash ^ 
+         inFixedValues->incomingValue[remoteAddrIndex].value.uint32) * 16777619;
+   }
+   else
+   {
+      const UINT8* localAddr = 
+         inFixedValues->incomingValue[localAddrIndex].value.byteArray16->byteArray16;
+      const UINT8* remoteAddr = 
+         inFixedValues->incomingValue[remoteAddrIndex].value.byteArray16->byteArray16;
+
+      for (i = 0; i < sizeof(FWP_BYTE_ARRAY16); i++)
+      {
+         hash = (hash ^ localAddr[i]) * 16777619;
+         hash = (hash ^ remoteAddr[i]) * 16777619;
+      }
+   }
+
+   hash = (hash ^ 
+      inFixedValues->incomingValue[localPortIndex].value.uint16) * 16777619;
+   hash = (hash ^ 
+      inFixedValues->incomingValue[remotePortIndex].value.uint16) * 16777619;
+   hash = (hash ^ 
+      inFixedValues->incomingValue[protocolIndex].value.uint8) * 16777619;
+
+   return &gWorkQueues[hash % gNumWorkQueues];
+}
+
 void
 FreePendedPacket(
    _Inout_ __drv_freesMem(Mem) TL_INSPECT_PENDED_PACKET* packet
@@ -247,6 +247,22 @@ GetNetwork5TupleIndexesForLayer(
    }
 }
 
+__inline
+void IncrementPacketQueueDepth(
+   _Inout_ TL_INSPECT_WORK_QUEUE* workQueue
+   )
+{
+   //
+   // The caller holds the packet queue lock of the work queue.
+   //
+   workQueue->packetQueueDepth++;
+
+   if (workQueue->packetQueueDepth > workQueue->packetQueuePeakDepth)
+   {
+      workQueue->packetQueuePeakDepth = workQueue->packetQueueDepth;
+   }
+}
+
 BOOLEAN IsAleReauthorize(
    _In_ const FWPS_INCOMING_VALUES* inFixedValues
    );
@@ -276,6 +292,12 @@ IsMatchingConnectPacket(
    _Inout_ TL_INSPECT_PENDED_PACKET* pendedPacket
    );
 
+TL_INSPECT_WORK_QUEUE*
+GetWorkQueueForFlow(
+   _In_ const FWPS_INCOMING_VALUES* inFixedValues,
+   _In_ ADDRESS_FAMILY addressFamily
+   );
+
 __drv_allocatesMem(Mem)
 TL_INSPECT_PENDED_PACKET*
 AllocateAndInitializePendedPacket(
@@ -41,6 +41,16 @@ Environment:
 #define MONITOR_STREAM_CALLOUT_DESCRIPTION L"Monitor Sample - Stream Callout"
 #define MONITOR_STREAM_CALLOUT_NAME L"Stream Callout"
 
+#define MONITOR_APP_CHANNEL_CAPACITY 1024
+
+typedef struct _MONITOR_APP_CHANNEL
+{
+   HANDLE            device;          // opened for overlapped I/O
+   MONITOR_CHANNEL*  channel;
+   OVERLAPPED        mapOverlapped;
+   LONG              dropped;         // drop count already reported
+} MONITOR_APP_CHANNEL;
+
 HANDLE quitEvent;
 
 DWORD
@@ -389,6 +399,293 @@ Return Value:
    return NO_ERROR;
 }
 
+DWORD
+MonitorAppMapChannel(
+   _Out_   MONITOR_APP_CHANNEL* appChannel)
+/*++
+
+Routine Description:
+
+   Allocates the event channel and hands it to the driver.  The map request
+   stays pending until MonitorAppUnmapChannel cancels it.
+
+Arguments:
+
+   [out] MONITOR_APP_CHANNEL* appChannel - Channel state.
+
+Return Value:
+
+   NO_ERROR or a specific CreateFile, VirtualAlloc or DeviceIoControl result.
+
+--*/
+{
+   DWORD result = NO_ERROR;
+   SIZE_T channelSize = MONITOR_CHANNEL_SIZE(MONITOR_APP_CHANNEL_CAPACITY);
+
+   RtlZeroMemory(appChannel, sizeof(MONITOR_APP_CHANNEL));
+
+   appChannel->device = CreateFileW(MONITOR_DOS_NAME, 
+                                    GENERIC_READ | GENERIC_WRITE, 
+                                    FILE_SHARE_READ | FILE_SHARE_WRITE, 
+                                    NULL, 
+                                    OPEN_EXISTING, 
+                                    FILE_FLAG_OVERLAPPED, 
+                                    NULL);
+   if (appChannel->device == INVALID_HANDLE_VALUE)
+   {
+      appChannel->device = NULL;
+      result = GetLastError();
+      goto cleanup;
+   }
+
+   appChannel->channel = (MONITOR_CHANNEL*) VirtualAlloc(NULL,
+                                                         channelSize,
+                                                         MEM_COMMIT | MEM_RESERVE,
+                                                         PAGE_READWRITE);
+   if (!appChannel->channel)
+   {
+      result = GetLastError();
+      goto cleanup;
+   }
+
+   appChannel->mapOverlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+   if (!appChannel->mapOverlapped.hEvent)
+   {
+      result = GetLastError();
+      goto cleanup;
+   }
+
+   if (DeviceIoControl(appChannel->device,
+                       MONITOR_IOCTL_MAP_CHANNEL,
+                       NULL,
+                       0,
+                       appChannel->channel,
+                       (DWORD) channelSize,
+                       NULL,
+                       &appChannel->mapOverlapped))
+   {
+      // The driver only completes the map request when it gives the channel up.
+      result = ERROR_INVALID_FUNCTION;
+      goto cleanup;
+   }
+
+   result = GetLastError();
+   if (ERROR_IO_PENDING == result)
+   {
+      result = NO_ERROR;
+   }
+
+cleanup:
+
+   return result;
+}
+
+void
+MonitorAppUnmapChannel(
+   _Inout_ MONITOR_APP_CHANNEL* appChannel)
+/*++
+
+Routine Description:
+
+   Cancels the map request, waits for the driver to let go of the channel and
+   frees it.
+
+--*/
+{
+   DWORD bytesReturned;
+
+   if (appChannel->device)
+   {
+      if (CancelIoEx(appChannel->device, &appChannel->mapOverlapped))
+      {
+         GetOverlappedResult(appChannel->device,
+                             &appChannel->mapOverlapped,
+                             &bytesReturned,
+                             TRUE);
+      }
+
+      CloseHandle(appChannel->device);
+      appChannel->device = NULL;
+   }
+
+   if (appChannel->mapOverlapped.hEvent)
+   {
+      CloseHandle(appChannel->mapOverlapped.hEvent);
+      appChannel->mapOverlapped.hEvent = NULL;
+   }
+
+   if (appChannel->channel)
+   {
+      VirtualFree(appChannel->channel, 0, MEM_RELEASE);
+      appChannel->channel = NULL;
+   }
+}
+
+void
+MonitorAppDrainChannel(
+   _Inout_ MONITOR_APP_CHANNEL* appChannel)
+/*++
+
+Routine Description:
+
+   Prints every event the driver has published since the last drain and hands
+   the slots back to the driver.
+
+--*/
+{
+   MONITOR_CHANNEL* channel = appChannel->channel;
+   ULONG readIndex = (ULONG) channel->readIndex;
+   ULONG writeIndex = (ULONG) channel->writeIndex;
+   LONG dropped;
+
+   // Read writeIndex before the events it publishes.
+   MemoryBarrier();
+
+   for (; readIndex != writeIndex; readIndex++)
+   {
+      const MONITOR_EVENT* event = &channel->events[readIndex % MONITOR_APP_CHANNEL_CAPACITY];
+      UINT32 previewLength = min(event->previewLength, MONITOR_EVENT_PREVIEW_SIZE);
+      UINT32 i;
+
+      printf("%s %u:%u %s%u bytes",
+             (event->flags & MONITOR_EVENT_FLAG_INBOUND) ? "<-" : "->",
+             event->localPort,
+             event->remotePort,
+             (event->flags & MONITOR_EVENT_FLAG_HTTP) ? "HTTP " : "",
+             event->payloadLength);
+
+      if (event->flags & MONITOR_EVENT_FLAG_HTTP)
+      {
+         printf(" (header %u bytes%s)",
+                event->headerLength,
+                (event->flags & MONITOR_EVENT_FLAG_TRUNCATED) ? ", truncated" : "");
+      }
+
+      printf("  ");
+
+      // Print the start of the message up to the end of its first line.
+      for (i = 0; i < previewLength; i++)
+      {
+         CHAR c = event->preview[i];
+
+         if ((c == '\r') || (c == '\n'))
+         {
+            break;
+         }
+
+         putchar(((c >= 0x20) && (c < 0x7f)) ? c : '.');
+      }
+
+      printf("\n");
+   }
+
+   // Hand the slots back before the driver can post again.
+   MemoryBarrier();
+   InterlockedExchange(&channel->readIndex, (LONG) writeIndex);
+
+   dropped = channel->dropped;
+   if (dropped != appChannel->dropped)
+   {
+      printf("%ld events dropped because the channel was full.\n",
+             dropped - appChannel->dropped);
+      appChannel->dropped = dropped;
+   }
+}
+
+DWORD
+MonitorAppReadChannel(
+   _Inout_ MONITOR_APP_CHANNEL* appChannel)
+/*++
+
+Routine Description:
+
+   Drains the channel, then parks a wait request in the driver until more
+   events show up, until quitEvent is signaled.
+
+Return Value:
+
+   NO_ERROR or a specific DeviceIoControl result.
+
+--*/
+{
+   DWORD result = NO_ERROR;
+   DWORD bytesReturned;
+   OVERLAPPED waitOverlapped;
+   HANDLE waitHandles[2];
+
+   RtlZeroMemory(&waitOverlapped, sizeof(OVERLAPPED));
+
+   waitOverlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+   if (!waitOverlapped.hEvent)
+   {
+      result = GetLastError();
+      goto cleanup;
+   }
+
+   waitHandles[0] = waitOverlapped.hEvent;
+   waitHandles[1] = quitEvent;
+
+   for (;;)
+   {
+      MonitorAppDrainChannel(appChannel);
+
+      ResetEvent(waitOverlapped.hEvent);
+
+      if (!DeviceIoControl(appChannel->device,
+                           MONITOR_IOCTL_WAIT_CHANNEL,
+                           NULL,
+                           0,
+                           NULL,
+                           0,
+                           NULL,
+                           &waitOverlapped))
+      {
+         result = GetLastError();
+         if (ERROR_IO_PENDING != result)
+         {
+            goto cleanup;
+         }
+
+         result = NO_ERROR;
+
+         if (WaitForMultipleObjects(2, waitHandles, FALSE, INFINITE) != WAIT_OBJECT_0)
+         {
+            CancelIoEx(appChannel->device, &waitOverlapped);
+            GetOverlappedResult(appChannel->device, &waitOverlapped, &bytesReturned, TRUE);
+            break;
+         }
+
+         if (!GetOverlappedResult(appChannel->device, &waitOverlapped, &bytesReturned, FALSE))
+         {
+            result = GetLastError();
+            goto cleanup;
+         }
+      }
+
+      if (WaitForSingleObject(quitEvent, 0) == WAIT_OBJECT_0)
+      {
+         break;
+      }
+   }
+
+cleanup:
+
+   if (waitOverlapped.hEvent)
+   {
+      CloseHandle(waitOverlapped.hEvent);
+   }
+
+   return result;
+}
+
+DWORD
+WINAPI
+MonitorAppChannelThread(
+   _In_ void* context)
+{
+   return MonitorAppReadChannel((MONITOR_APP_CHANNEL*) context);
+}
+
 DWORD
 MonitorAppAddFilters(
    _In_    HANDLE         engineHandle,
@@ -565,7 +862,10 @@ MonitorAppDoMonitoring(PCWSTR AppPath)
    MONITOR_SETTINGS  monitorSettings;
    FWPM_SESSION     session;
    FWP_BYTE_BLOB*    applicationId = NULL;
+   MONITOR_APP_CHANNEL appChannel;
+   HANDLE            channelThread = NULL;
 
+   RtlZeroMemory(&appChannel, sizeof(MONITOR_APP_CHANNEL));
    RtlZeroMemory(&monitorSettings, sizeof(MONITOR_SETTINGS));
    RtlZeroMemory(&session, sizeof(FWPM_SESSION));
 
@@ -611,6 +911,30 @@ MonitorAppDoMonitoring(PCWSTR AppPath)
 
    printf("Successfully opened Monitor Device\n");
 
+   printf("Mapping the event channel\n");
+
+   result = MonitorAppMapChannel(&appChannel);
+   if (NO_ERROR != result)
+   {
+      goto cleanup;
+   }
+
+   quitEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+   if (!quitEvent)
+   {
+      result = GetLastError();
+      goto cleanup;
+   }
+
+   channelThread = CreateThread(NULL, 0, MonitorAppChannelThread, &appChannel, 0, NULL);
+   if (!channelThread)
+   {
+      result = GetLastError();
+      goto cleanup;
+   }
+
+   printf("Successfully mapped the event channel\n");
+
    printf("Adding Filters through the Filtering Engine\n");
 
    result = MonitorAppAddFilters(engineHandle, 
@@ -636,7 +960,7 @@ MonitorAppDoMonitoring(PCWSTR AppPath)
 
    printf("Successfully enabled monitoring.\n");
 
-   printf("Events will be traced through WMI. Please press any key to exit and cleanup filters.\n");
+   printf("Events will be shown below and traced through WMI. Please press any key to exit and cleanup filters.\n");
 
 #pragma prefast(push)
 #pragma prefast(disable:6031, "by design the return value of _getch() is ignored here")
@@ -650,6 +974,21 @@ cleanup:
       printf("Monitor.\tError 0x%x occurred during execution\n", result);
    }
 
+   if (channelThread)
+   {
+      SetEvent(quitEvent);
+      WaitForSingleObject(channelThread, INFINITE);
+      CloseHandle(channelThread);
+   }
+
+   if (quitEvent)
+   {
+      CloseHandle(quitEvent);
+      quitEvent = NULL;
+   }
+
+   MonitorAppUnmapChannel(&appChannel);
+
    if (monitorDevice)
    {
       MonitorAppCloseMonitorDevice(monitorDevice);
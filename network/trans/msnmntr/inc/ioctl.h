@@ -34,3 +34,49 @@ typedef struct _MONITOR_SETTINGS
 #define	MONITOR_IOCTL_ENABLE_MONITOR  CTL_CODE(FILE_DEVICE_NETWORK, 0x1, METHOD_BUFFERED, FILE_ANY_ACCESS)
 #define	MONITOR_IOCTL_DISABLE_MONITOR CTL_CODE(FILE_DEVICE_NETWORK, 0x2, METHOD_BUFFERED, FILE_ANY_ACCESS)
 
+//
+// Event channel.
+//
+// MONITOR_IOCTL_MAP_CHANNEL hands the driver an output buffer that holds a
+// MONITOR_CHANNEL.  The driver locks and maps the buffer and keeps the request
+// pending for as long as the channel is in use; cancel the request (or close
+// the handle) to unmap it.  The driver appends events at writeIndex and the
+// application consumes them at readIndex.  Both indexes only ever increase;
+// the slot is the index modulo capacity.
+//
+// MONITOR_IOCTL_WAIT_CHANNEL completes as soon as the channel holds at least
+// one unread event, so one completion covers every event queued since the
+// application last drained the channel.
+//
+#define	MONITOR_IOCTL_MAP_CHANNEL     CTL_CODE(FILE_DEVICE_NETWORK, 0x3, METHOD_OUT_DIRECT, FILE_ANY_ACCESS)
+#define	MONITOR_IOCTL_WAIT_CHANNEL    CTL_CODE(FILE_DEVICE_NETWORK, 0x4, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+#define MONITOR_EVENT_FLAG_INBOUND    0x00000001
+#define MONITOR_EVENT_FLAG_HTTP       0x00000002  // message started with an HTTP request or status line
+#define MONITOR_EVENT_FLAG_TRUNCATED  0x00000004  // header outgrew the flow's ring buffer, preview is its tail
+
+#define MONITOR_EVENT_PREVIEW_SIZE    64
+
+typedef struct _MONITOR_EVENT
+{
+   UINT32   flags;
+   USHORT   localPort;
+   USHORT   remotePort;
+   UINT32   headerLength;     // HTTP header bytes, including the blank line
+   UINT32   payloadLength;    // bytes following the header
+   UINT32   previewLength;
+   CHAR     preview[MONITOR_EVENT_PREVIEW_SIZE];
+} MONITOR_EVENT;
+
+typedef struct _MONITOR_CHANNEL
+{
+   volatile LONG  writeIndex; // advanced by the driver
+   volatile LONG  readIndex;  // advanced by the application
+   volatile LONG  dropped;    // events lost because the channel was full
+   UINT32         capacity;   // number of events, filled in by the driver
+   MONITOR_EVENT  events[1];
+} MONITOR_CHANNEL;
+
+#define MONITOR_CHANNEL_SIZE(capacity) \
+   (FIELD_OFFSET(MONITOR_CHANNEL, events) + (capacity) * sizeof(MONITOR_EVENT))
+
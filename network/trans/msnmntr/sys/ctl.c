@@ -139,11 +139,28 @@ MonitorEvtDeviceControl (
          break;
       }
 
+      case MONITOR_IOCTL_MAP_CHANNEL:
+      {
+         status = MonitorNfMapChannel(Request);
+         break;
+      }
+
+      case MONITOR_IOCTL_WAIT_CHANNEL:
+      {
+         status = MonitorNfWaitChannel(Request);
+         break;
+      }
+
       default:
       {
          status = STATUS_INVALID_PARAMETER;
       }
    }
 
-   WdfRequestComplete(Request, status);
+   // The channel requests that were parked on a notify queue are completed
+   // from there.
+   if (status != STATUS_PENDING)
+   {
+      WdfRequestComplete(Request, status);
+   }
 }
@@ -12,6 +12,7 @@ Environment:
 
 #include <ntddk.h>
 #include <ntstrsafe.h>
+#include <wdf.h>
 
 #include <fwpmk.h>
 
@@ -740,8 +741,7 @@ Notes
 
       status = MonitorNfNotifyMessage(streamPacket->streamData,
                                       inbound,
-                                      flowData->localPort,
-                                      flowData->remotePort);
+                                      flowData);
    }
 
 cleanup:
@@ -14,6 +14,25 @@ Environment:
 
 #pragma once
 
+#define MONITOR_FLOW_RING_SIZE 256
+
+//
+// Per direction parse state.  A message header can span several stream
+// indications; its bytes are kept in a ring so that nothing has to be
+// allocated or copied a second time while waiting for the rest of it.
+// Stream classifies are serialized per flow and direction, so no lock is
+// needed.
+//
+typedef struct _MONITOR_STREAM_PARSER
+{
+   UINT32      state;
+   UINT32      terminatorMatched;   // bytes of "\r\n\r\n" seen so far
+   UINT32      headerLength;        // header bytes consumed so far
+   UINT32      ringHead;            // next byte to write in ring
+   BOOLEAN     ringWrapped;
+   BYTE        ring[MONITOR_FLOW_RING_SIZE];
+} MONITOR_STREAM_PARSER;
+
 typedef struct _FLOW_DATA
 {
    UINT64      flowHandle;
@@ -27,6 +46,8 @@ typedef struct _FLOW_DATA
    WCHAR*      processPath;
    LIST_ENTRY  listEntry;
    BOOLEAN     deleting;
+   MONITOR_STREAM_PARSER outboundParser;
+   MONITOR_STREAM_PARSER inboundParser;
 } FLOW_DATA;
 
 NTSTATUS
@@ -13,6 +13,7 @@ Environment:
 --*/
 
 #include <ntddk.h>
+#include <wdf.h>
 
 #include <fwpmk.h>
 
@@ -45,250 +46,697 @@ Environment:
 
 #define TAG_NAME_NOTIFY 'oNnM'
 
+#define MONITOR_PARSER_MESSAGE_START   0
+#define MONITOR_PARSER_HTTP_HEADER     1
+
+static const CHAR gHeaderTerminator[] = "\r\n\r\n";
+
+#define MONITOR_HEADER_TERMINATOR_LENGTH (sizeof(gHeaderTerminator) - 1)
+
+//
+// Walks the bytes described by a FWPS_STREAM_DATA in place, one mapped MDL
+// fragment at a time.
+//
+typedef struct _MONITOR_STREAM_CURSOR
+{
+   NET_BUFFER_LIST*  netBufferList;
+   NET_BUFFER*       netBuffer;
+   MDL*              mdl;
+   SIZE_T            mdlOffset;
+   SIZE_T            netBufferRemaining;
+   SIZE_T            remaining;
+} MONITOR_STREAM_CURSOR;
+
+//
+// The event channel shared with monitor.exe.
+//
+typedef struct _MONITOR_NOTIFY_CHANNEL
+{
+   KSPIN_LOCK        lock;
+   WDFQUEUE          mapQueue;
+   WDFQUEUE          waitQueue;
+   WDFREQUEST        mapRequest;
+   MONITOR_CHANNEL*  channel;
+   UINT32            capacity;
+} MONITOR_NOTIFY_CHANNEL;
+
+MONITOR_NOTIFY_CHANNEL gNotifyChannel;
+
+EVT_WDF_IO_QUEUE_IO_CANCELED_ON_QUEUE MonitorEvtMapChannelCanceledOnQueue;
+
 NTSTATUS
 MonitorNfInitialize(
    _In_ DEVICE_OBJECT* deviceObject)
 {
-   UNREFERENCED_PARAMETER(deviceObject);
+   NTSTATUS status;
+   WDFDEVICE device;
+   WDF_IO_QUEUE_CONFIG queueConfig;
 
-   return STATUS_SUCCESS;
+   KeInitializeSpinLock(&gNotifyChannel.lock);
+
+   device = WdfWdmDeviceGetWdfDeviceHandle(deviceObject);
+
+   //
+   // The map request stays on this queue for as long as the channel is
+   // mapped.  Cancelling it unmaps the channel.
+   //
+   WDF_IO_QUEUE_CONFIG_INIT(&queueConfig, WdfIoQueueDispatchManual);
+   queueConfig.EvtIoCanceledOnQueue = MonitorEvtMapChannelCanceledOnQueue;
+
+   status = WdfIoQueueCreate(device,
+                             &queueConfig,
+                             WDF_NO_OBJECT_ATTRIBUTES,
+                             &gNotifyChannel.mapQueue);
+   if (!NT_SUCCESS(status))
+   {
+      goto cleanup;
+   }
+
+   //
+   // Wait requests are parked here until the channel goes from empty to
+   // non-empty.  The framework cancels them for us.
+   //
+   WDF_IO_QUEUE_CONFIG_INIT(&queueConfig, WdfIoQueueDispatchManual);
+
+   status = WdfIoQueueCreate(device,
+                             &queueConfig,
+                             WDF_NO_OBJECT_ATTRIBUTES,
+                             &gNotifyChannel.waitQueue);
+
+cleanup:
+
+   return status;
 }
 
 NTSTATUS
 MonitorNfUninitialize(void)
 {
-   return STATUS_SUCCESS;
-}
+   KLOCK_QUEUE_HANDLE lockHandle;
 
-__forceinline
-void*
-MonitorNfpFindCharacters(
-   _In_reads_bytes_(streamLength) const char* stream,
-   _In_ size_t streamLength,
-   _In_reads_bytes_(subStreamLength) const char* subStream,
-   _In_ size_t subStreamLength,
-   _Out_ size_t* bytesLeft)
-{
-   size_t currentOffset = 0;
-   void* subStreamPtr = NULL;
-   
-   *bytesLeft = streamLength;
+   KeAcquireInStackQueuedSpinLock(&gNotifyChannel.lock, &lockHandle);
+
+   gNotifyChannel.channel = NULL;
+   gNotifyChannel.capacity = 0;
 
-   if (subStreamLength > streamLength)
+   KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+   if (gNotifyChannel.waitQueue)
    {
-      return NULL;
+      WdfIoQueuePurgeSynchronously(gNotifyChannel.waitQueue);
    }
 
-   while (currentOffset+subStreamLength <= streamLength)
+   if (gNotifyChannel.mapQueue)
    {
-      if (0 == memcmp((void*)(stream+currentOffset), subStream, subStreamLength))
-      {
-         subStreamPtr = (void*)(char*)(stream+currentOffset);
-         *bytesLeft = streamLength;
-         *bytesLeft -= currentOffset;
-         *bytesLeft -= subStreamLength;
-         break;
-      }
-      currentOffset += subStreamLength;
+      WdfIoQueuePurgeSynchronously(gNotifyChannel.mapQueue);
    }
-   
-   return subStreamPtr;
+
+   return STATUS_SUCCESS;
 }
 
-NTSTATUS
-MonitorNfParseMessageInbound(
-   _In_reads_bytes_(streamLength) BYTE* stream,
-   _In_ size_t streamLength,
-   _In_ USHORT localPort,
-   _In_ USHORT remotePort)
+VOID
+MonitorEvtMapChannelCanceledOnQueue(
+   _In_ WDFQUEUE Queue,
+   _In_ WDFREQUEST Request
+   )
+/*++
+
+Routine Description:
+
+   Called when monitor.exe cancels the map request or closes its handle.
+   Detaches the channel before the request completes and its pages are
+   unlocked.
+
+--*/
 {
-   UNREFERENCED_PARAMETER(stream);
+   KLOCK_QUEUE_HANDLE lockHandle;
 
-   DoTraceMessage(TRACE_CLIENT_SERVER,
-               "%Id bytes received. Local Port: %d Remote Port: %d.",
-               streamLength,
-               localPort,
-               remotePort);
-   return STATUS_SUCCESS;
+   UNREFERENCED_PARAMETER(Queue);
+
+   KeAcquireInStackQueuedSpinLock(&gNotifyChannel.lock, &lockHandle);
+
+   if (gNotifyChannel.mapRequest == Request)
+   {
+      gNotifyChannel.mapRequest = NULL;
+      gNotifyChannel.channel = NULL;
+      gNotifyChannel.capacity = 0;
+   }
+
+   KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+   WdfRequestComplete(Request, STATUS_CANCELLED);
 }
 
 NTSTATUS
-MonitorNfParseMessageInboundHttpHeader(
-   _In_reads_bytes_(streamLength) BYTE* stream,
-   _In_ size_t streamLength,
-   _In_ USHORT localPort,
-   _In_ USHORT remotePort)
+MonitorNfMapChannel(
+   _In_ WDFREQUEST request)
+/*++
+
+Routine Description:
+
+   Maps the MONITOR_CHANNEL described by the output buffer of a
+   MONITOR_IOCTL_MAP_CHANNEL request and keeps the request pending.
+
+Return Value:
+
+   STATUS_PENDING if the request now belongs to the map queue; otherwise the
+   caller completes it with the returned status.
+
+--*/
 {
-   BYTE* msgStart = NULL;
-   size_t bytesLeft;
-   NTSTATUS status = STATUS_INVALID_PARAMETER;
-   
-   // Walk past the HTTP header.
-   msgStart = (BYTE*) MonitorNfpFindCharacters((char*)stream, 
-                                               streamLength,
-                                               "\r\n\r\n",
-                                               (ULONG)strlen("\r\n\r\n"),
-                                               &bytesLeft);
-   if (msgStart && (bytesLeft > 0))
+   NTSTATUS status;
+   MDL* mdl;
+   MONITOR_CHANNEL* channel;
+   SIZE_T channelSize;
+   KLOCK_QUEUE_HANDLE lockHandle;
+
+   status = WdfRequestRetrieveOutputWdmMdl(request, &mdl);
+   if (!NT_SUCCESS(status))
    {
-      size_t msgLength;
+      goto cleanup;
+   }
+
+   channelSize = MmGetMdlByteCount(mdl);
+   if (channelSize < MONITOR_CHANNEL_SIZE(1))
+   {
+      status = STATUS_BUFFER_TOO_SMALL;
+      goto cleanup;
+   }
 
-      msgStart += 4; // step past \r\n\r\n.
+   channel = MmGetSystemAddressForMdlSafe(mdl, NormalPagePriority);
+   if (!channel)
+   {
+      status = STATUS_INSUFFICIENT_RESOURCES;
+      goto cleanup;
+   }
 
-      msgLength = streamLength - (ULONG)(ULONG_PTR)(msgStart - stream);
-      
-      // Do the final inbound message processing.
-      status = MonitorNfParseMessageInbound(msgStart,
-                                            msgLength,
-                                            localPort,
-                                            remotePort);
+   KeAcquireInStackQueuedSpinLock(&gNotifyChannel.lock, &lockHandle);
+
+   if (gNotifyChannel.mapRequest)
+   {
+      status = STATUS_DEVICE_BUSY;
+   }
+   else
+   {
+      channel->writeIndex = 0;
+      channel->readIndex = 0;
+      channel->dropped = 0;
+      channel->capacity = (UINT32)((channelSize - FIELD_OFFSET(MONITOR_CHANNEL, events)) /
+                                   sizeof(MONITOR_EVENT));
+
+      gNotifyChannel.capacity = channel->capacity;
+      gNotifyChannel.channel = channel;
+      gNotifyChannel.mapRequest = request;
+   }
+
+   KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+   if (!NT_SUCCESS(status))
+   {
+      goto cleanup;
    }
 
+   status = WdfRequestForwardToIoQueue(request, gNotifyChannel.mapQueue);
+   if (!NT_SUCCESS(status))
+   {
+      KeAcquireInStackQueuedSpinLock(&gNotifyChannel.lock, &lockHandle);
+
+      gNotifyChannel.mapRequest = NULL;
+      gNotifyChannel.channel = NULL;
+      gNotifyChannel.capacity = 0;
+
+      KeReleaseInStackQueuedSpinLock(&lockHandle);
+   }
+   else
+   {
+      DoTraceMessage(TRACE_ALL_TRAFFIC,
+                     "Event channel mapped, %d events.",
+                     gNotifyChannel.capacity);
+
+      status = STATUS_PENDING;
+   }
+
+cleanup:
+
    return status;
 }
 
 NTSTATUS
-MonitorNfParseMessageOutbound(
-   _In_reads_bytes_(streamLength) BYTE* stream,
-   _In_ size_t streamLength,
-   _In_ USHORT localPort,
-   _In_ USHORT remotePort)
+MonitorNfWaitChannel(
+   _In_ WDFREQUEST request)
+/*++
+
+Routine Description:
+
+   Handles MONITOR_IOCTL_WAIT_CHANNEL.  If unread events are already in the
+   channel the caller completes the request right away, otherwise it is
+   parked until MonitorNfpPostEvent makes the channel non-empty.
+
+Return Value:
+
+   STATUS_PENDING if the request now belongs to the wait queue; otherwise the
+   caller completes it with the returned status.
+
+--*/
 {
-   UNREFERENCED_PARAMETER(stream);
+   NTSTATUS status = STATUS_SUCCESS;
+   KLOCK_QUEUE_HANDLE lockHandle;
 
-   DoTraceMessage(TRACE_CLIENT_SERVER,
-               "%Id bytes sent. Local Port: %d Remote Port: %d.",
-               streamLength,
-               localPort,
-               remotePort);
-   return STATUS_SUCCESS;
+   KeAcquireInStackQueuedSpinLock(&gNotifyChannel.lock, &lockHandle);
+
+   if (!gNotifyChannel.channel)
+   {
+      status = STATUS_INVALID_DEVICE_STATE;
+   }
+   else if (gNotifyChannel.channel->writeIndex == gNotifyChannel.channel->readIndex)
+   {
+      //
+      // Forward while holding the lock so that a producer cannot post the
+      // first event between the check and the forward and miss us.
+      //
+      status = WdfRequestForwardToIoQueue(request, gNotifyChannel.waitQueue);
+      if (NT_SUCCESS(status))
+      {
+         status = STATUS_PENDING;
+      }
+   }
+
+   KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+   return status;
 }
 
-NTSTATUS
-MonitorNfParseMessageOutboundHttpHeader(
-   _In_reads_bytes_(streamLength) BYTE* stream,
-   _In_ size_t streamLength,
-   _In_ USHORT localPort,
-   _In_ USHORT remotePort)
+static void
+MonitorNfpPostEvent(
+   _In_ const MONITOR_EVENT* event)
+/*++
+
+Routine Description:
+
+   Appends an event to the shared channel.  readIndex lives in user memory and
+   is not trusted; a bogus value only makes the channel look full.  The
+   pending wait request, if any, is completed only when the channel goes from
+   empty to non-empty.
+
+--*/
 {
-   BYTE* msgStart = NULL;
-   size_t bytesLeft;
-   NTSTATUS status = STATUS_SUCCESS;
-   
-   // Walk past the HTTP header.
-   msgStart = (BYTE*) MonitorNfpFindCharacters((char*)stream, 
-                                               streamLength,
-                                               "\r\n\r\n",
-                                               (ULONG)strlen("\r\n\r\n"),
-                                               &bytesLeft);
-   if (msgStart && (bytesLeft > 0))
+   KLOCK_QUEUE_HANDLE lockHandle;
+   MONITOR_CHANNEL* channel;
+   WDFREQUEST waitRequest = NULL;
+   ULONG writeIndex;
+   ULONG used;
+
+   KeAcquireInStackQueuedSpinLock(&gNotifyChannel.lock, &lockHandle);
+
+   channel = gNotifyChannel.channel;
+   if (!channel)
    {
-      size_t msgLength;
+      goto cleanup;
+   }
 
-      msgStart += 4; // step past \r\n\r\n.
+   writeIndex = (ULONG) channel->writeIndex;
+   used = writeIndex - (ULONG) channel->readIndex;
 
-      msgLength = streamLength - (ULONG)(ULONG_PTR)(msgStart - stream);
-      status = MonitorNfParseMessageOutbound(msgStart,
-                                             msgLength,
-                                             localPort,
-                                             remotePort);
+   if (used >= gNotifyChannel.capacity)
+   {
+      InterlockedIncrement(&channel->dropped);
+      goto cleanup;
+   }
+
+   RtlCopyMemory(&channel->events[writeIndex % gNotifyChannel.capacity],
+                 event,
+                 sizeof(MONITOR_EVENT));
+
+   // The event must be visible before the index that publishes it.
+   KeMemoryBarrier();
+
+   channel->writeIndex = (LONG)(writeIndex + 1);
+
+   if (used == 0)
+   {
+      if (!NT_SUCCESS(WdfIoQueueRetrieveNextRequest(gNotifyChannel.waitQueue,
+                                                    &waitRequest)))
+      {
+         waitRequest = NULL;
+      }
+   }
+
+cleanup:
+
+   KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+   if (waitRequest)
+   {
+      WdfRequestComplete(waitRequest, STATUS_SUCCESS);
    }
-   
-   return status;
 }
 
-NTSTATUS
-MonitorNfParseStreamAndTraceMessage(
-   _In_reads_bytes_(streamLength) BYTE* stream,
-   _In_ size_t streamLength,
-   _In_ BOOLEAN inbound,
-   _In_ USHORT localPort,
-   _In_ USHORT remotePort)
+static void
+MonitorNfpCursorInitialize(
+   _In_ const FWPS_STREAM_DATA* streamData,
+   _Out_ MONITOR_STREAM_CURSOR* cursor)
 {
-   NTSTATUS status;
+   MDL* mdl;
+   SIZE_T mdlOffset;
+   SIZE_T consumed = 0;
+
+   cursor->netBufferList = streamData->dataOffset.netBufferList;
+   cursor->netBuffer = streamData->dataOffset.netBuffer;
+   cursor->mdl = streamData->dataOffset.mdl;
+   cursor->mdlOffset = streamData->dataOffset.mdlOffset;
+   cursor->remaining = streamData->dataLength;
+
+   //
+   // The data offset may point part way into the first NET_BUFFER; work out
+   // how much of it is left so we never read past its data length.
+   //
+   mdlOffset = NET_BUFFER_CURRENT_MDL_OFFSET(cursor->netBuffer);
+
+   for (mdl = NET_BUFFER_CURRENT_MDL(cursor->netBuffer);
+        mdl && (mdl != cursor->mdl);
+        mdl = mdl->Next)
+   {
+      consumed += MmGetMdlByteCount(mdl) - mdlOffset;
+      mdlOffset = 0;
+   }
+
+   consumed += cursor->mdlOffset - mdlOffset;
+
+   cursor->netBufferRemaining = NET_BUFFER_DATA_LENGTH(cursor->netBuffer) - consumed;
+}
+
+static BOOLEAN
+MonitorNfpCursorNext(
+   _Inout_ MONITOR_STREAM_CURSOR* cursor,
+   _Outptr_result_bytebuffer_(*chunkLength) BYTE** chunk,
+   _Out_ SIZE_T* chunkLength,
+   _Out_ NTSTATUS* status)
+/*++
 
-   if (!inbound)
+Routine Description:
+
+   Returns the next mapped, contiguous run of stream bytes and advances the
+   cursor past it.  Moves on to the next NET_BUFFER, and then the next
+   NET_BUFFER_LIST, when the current one is used up.
+
+--*/
+{
+   BYTE* mdlVa;
+   SIZE_T available;
+
+   *chunk = NULL;
+   *chunkLength = 0;
+   *status = STATUS_SUCCESS;
+
+   while (cursor->remaining)
    {
-      if ((_strnicmp((const char*)stream, "POST", streamLength) == 0)
-          || (_strnicmp((const char*)stream, "GET", streamLength) == 0))
+      if (!cursor->netBufferRemaining || !cursor->mdl)
       {
-         if ((MonitorNfParseMessageOutboundHttpHeader(stream,
-                                                      streamLength,
-                                                      localPort,
-                                                      remotePort)) != STATUS_SUCCESS)
-           return STATUS_INSUFFICIENT_RESOURCES; 
+         cursor->netBuffer = NET_BUFFER_NEXT_NB(cursor->netBuffer);
+         if (!cursor->netBuffer)
+         {
+            cursor->netBufferList = NET_BUFFER_LIST_NEXT_NBL(cursor->netBufferList);
+            if (!cursor->netBufferList)
+            {
+               break;
+            }
+
+            cursor->netBuffer = NET_BUFFER_LIST_FIRST_NB(cursor->netBufferList);
+         }
+
+         cursor->mdl = NET_BUFFER_CURRENT_MDL(cursor->netBuffer);
+         cursor->mdlOffset = NET_BUFFER_CURRENT_MDL_OFFSET(cursor->netBuffer);
+         cursor->netBufferRemaining = NET_BUFFER_DATA_LENGTH(cursor->netBuffer);
+         continue;
       }
-      else
+
+      available = MmGetMdlByteCount(cursor->mdl) - cursor->mdlOffset;
+      if (!available)
       {
-         if ((MonitorNfParseMessageOutbound(stream,
-                                            streamLength,
-                                            localPort,
-                                            remotePort)!= STATUS_SUCCESS))
-           return STATUS_INSUFFICIENT_RESOURCES;
+         cursor->mdl = cursor->mdl->Next;
+         cursor->mdlOffset = 0;
+         continue;
       }
-   }
-   else
-   {
-      if (_strnicmp((const char*)stream, "HTTP", streamLength) == 0)
+
+      mdlVa = MmGetSystemAddressForMdlSafe(cursor->mdl, NormalPagePriority);
+      if (!mdlVa)
       {
-         if ((MonitorNfParseMessageInboundHttpHeader(stream,
-                                                     streamLength,
-                                                     localPort,
-                                                     remotePort)) != STATUS_SUCCESS)
-            return STATUS_INSUFFICIENT_RESOURCES;
+         *status = STATUS_INSUFFICIENT_RESOURCES;
+         break;
       }
-      else
+
+      available = min(available, cursor->netBufferRemaining);
+      available = min(available, cursor->remaining);
+
+      *chunk = mdlVa + cursor->mdlOffset;
+      *chunkLength = available;
+
+      cursor->mdlOffset += available;
+      cursor->netBufferRemaining -= available;
+      cursor->remaining -= available;
+
+      return TRUE;
+   }
+
+   return FALSE;
+}
+
+static SIZE_T
+MonitorNfpCursorPeek(
+   _In_ const MONITOR_STREAM_CURSOR* cursor,
+   _Out_writes_bytes_to_(bufferLength, return) BYTE* buffer,
+   _In_ SIZE_T bufferLength)
+/*++
+
+Routine Description:
+
+   Copies the first bytes under the cursor without advancing it.  Used to
+   look at the start of a message regardless of how it was fragmented.
+
+--*/
+{
+   MONITOR_STREAM_CURSOR peek = *cursor;
+   BYTE* chunk;
+   SIZE_T chunkLength;
+   SIZE_T copied = 0;
+   NTSTATUS status;
+
+   while ((copied < bufferLength) &&
+          MonitorNfpCursorNext(&peek, &chunk, &chunkLength, &status))
+   {
+      chunkLength = min(chunkLength, bufferLength - copied);
+      RtlCopyMemory(buffer + copied, chunk, chunkLength);
+      copied += chunkLength;
+   }
+
+   return copied;
+}
+
+static void
+MonitorNfpParserAppend(
+   _Inout_ MONITOR_STREAM_PARSER* parser,
+   _In_reads_bytes_(length) const BYTE* bytes,
+   _In_ SIZE_T length)
+{
+   SIZE_T copy;
+
+   // Only the last MONITOR_FLOW_RING_SIZE bytes can survive.
+   if (length > MONITOR_FLOW_RING_SIZE)
+   {
+      bytes += length - MONITOR_FLOW_RING_SIZE;
+      length = MONITOR_FLOW_RING_SIZE;
+      parser->ringWrapped = TRUE;
+   }
+
+   while (length)
+   {
+      copy = min(length, MONITOR_FLOW_RING_SIZE - parser->ringHead);
+
+      RtlCopyMemory(parser->ring + parser->ringHead, bytes, copy);
+
+      parser->ringHead += (UINT32) copy;
+      if (parser->ringHead == MONITOR_FLOW_RING_SIZE)
       {
-         if ((MonitorNfParseMessageInbound(stream,
-                                           streamLength,
-                                           localPort,
-                                           remotePort)) != STATUS_SUCCESS)
-            return STATUS_INSUFFICIENT_RESOURCES;
+         parser->ringHead = 0;
+         parser->ringWrapped = TRUE;
       }
+
+      bytes += copy;
+      length -= copy;
    }
+}
+
+static void
+MonitorNfpParserPreview(
+   _In_ const MONITOR_STREAM_PARSER* parser,
+   _Inout_ MONITOR_EVENT* event)
+/*++
+
+Routine Description:
+
+   Copies the oldest bytes held in the ring into the event.  That is the start
+   of the header unless the header outgrew the ring.
+
+--*/
+{
+   UINT32 start = parser->ringWrapped ? parser->ringHead : 0;
+   UINT32 held = parser->ringWrapped ? MONITOR_FLOW_RING_SIZE : parser->ringHead;
+   UINT32 copy;
 
+   event->previewLength = min(held, MONITOR_EVENT_PREVIEW_SIZE);
+
+   copy = min(event->previewLength, MONITOR_FLOW_RING_SIZE - start);
+   RtlCopyMemory(event->preview, parser->ring + start, copy);
+   RtlCopyMemory(event->preview + copy, parser->ring, event->previewLength - copy);
+
+   if (parser->ringWrapped)
    {
-      status = STATUS_SUCCESS;
+      event->flags |= MONITOR_EVENT_FLAG_TRUNCATED;
    }
+}
 
-   return status;
+static BOOLEAN
+MonitorNfpIsHttpStart(
+   _In_reads_bytes_(length) const BYTE* start,
+   _In_ SIZE_T length,
+   _In_ BOOLEAN inbound)
+{
+   if (inbound)
+   {
+      return (BOOLEAN)((length >= 4) && (_strnicmp((const char*)start, "HTTP", 4) == 0));
+   }
+
+   return (BOOLEAN)(((length >= 4) && (_strnicmp((const char*)start, "POST", 4) == 0)) ||
+                    ((length >= 3) && (_strnicmp((const char*)start, "GET", 3) == 0)));
 }
 
+static void
+MonitorNfpTraceEvent(
+   _In_ const MONITOR_EVENT* event)
+{
+   if (event->flags & MONITOR_EVENT_FLAG_INBOUND)
+   {
+      DoTraceMessage(TRACE_CLIENT_SERVER,
+                  "%d bytes received. Local Port: %d Remote Port: %d.",
+                  event->payloadLength,
+                  event->localPort,
+                  event->remotePort);
+   }
+   else
+   {
+      DoTraceMessage(TRACE_CLIENT_SERVER,
+                  "%d bytes sent. Local Port: %d Remote Port: %d.",
+                  event->payloadLength,
+                  event->localPort,
+                  event->remotePort);
+   }
+}
 
 NTSTATUS MonitorNfNotifyMessage(
    _In_ const FWPS_STREAM_DATA* streamBuffer,
    _In_ BOOLEAN inbound,
-   _In_ USHORT localPort,
-   _In_ USHORT remotePort
+   _Inout_ FLOW_DATA* flowData
 )
+/*++
+
+Routine Description:
+
+   Parses one stream indication straight out of its MDL chain.
+
+   Data that does not start with an HTTP request or status line is reported
+   as one message.  An HTTP header is accumulated in the flow's ring until the
+   blank line that ends it shows up, which may be several indications later;
+   the message is then reported with whatever follows the header in the
+   indication that completed it.
+
+--*/
 {
    NTSTATUS status = STATUS_SUCCESS;
-   BYTE* stream = NULL;
-   SIZE_T streamLength = streamBuffer->dataLength;
-   SIZE_T bytesCopied = 0;
-
-   if(streamLength == 0)
+   MONITOR_STREAM_PARSER* parser;
+   MONITOR_STREAM_CURSOR cursor;
+   MONITOR_EVENT event;
+   BYTE* chunk;
+   SIZE_T chunkLength;
+   SIZE_T i;
+
+   if (streamBuffer->dataLength == 0)
       return status;
 
-   stream =  ExAllocatePoolWithTag(NonPagedPool,
-                                   streamLength,
-                                   TAG_NAME_NOTIFY);
-   if (!stream)
-      return STATUS_INSUFFICIENT_RESOURCES;
+   parser = inbound ? &flowData->inboundParser : &flowData->outboundParser;
+
+   RtlZeroMemory(&event, sizeof(event));
+
+   event.flags = inbound ? MONITOR_EVENT_FLAG_INBOUND : 0;
+   event.localPort = flowData->localPort;
+   event.remotePort = flowData->remotePort;
+
+   MonitorNfpCursorInitialize(streamBuffer, &cursor);
+
+   if (parser->state == MONITOR_PARSER_MESSAGE_START)
+   {
+      event.previewLength = (UINT32) MonitorNfpCursorPeek(&cursor,
+                                                          (BYTE*) event.preview,
+                                                          sizeof(event.preview));
+
+      if (!MonitorNfpIsHttpStart((const BYTE*) event.preview,
+                                 event.previewLength,
+                                 inbound))
+      {
+         event.payloadLength = (UINT32) streamBuffer->dataLength;
+         goto post;
+      }
+
+      parser->state = MONITOR_PARSER_HTTP_HEADER;
+      parser->terminatorMatched = 0;
+      parser->headerLength = 0;
+      parser->ringHead = 0;
+      parser->ringWrapped = FALSE;
+   }
+
+   while (MonitorNfpCursorNext(&cursor, &chunk, &chunkLength, &status))
+   {
+      for (i = 0; i < chunkLength; i++)
+      {
+         if (chunk[i] == (BYTE) gHeaderTerminator[parser->terminatorMatched])
+         {
+            parser->terminatorMatched++;
+         }
+         else
+         {
+            parser->terminatorMatched = (chunk[i] == '\r') ? 1 : 0;
+         }
+
+         if (parser->terminatorMatched == MONITOR_HEADER_TERMINATOR_LENGTH)
+         {
+            i++;
+            break;
+         }
+      }
+
+      MonitorNfpParserAppend(parser, chunk, i);
+      parser->headerLength += (UINT32) i;
+
+      if (parser->terminatorMatched == MONITOR_HEADER_TERMINATOR_LENGTH)
+      {
+         event.flags |= MONITOR_EVENT_FLAG_HTTP;
+         event.headerLength = parser->headerLength;
+         event.payloadLength = (UINT32)(chunkLength - i + cursor.remaining);
 
-   RtlZeroMemory(stream,streamLength);
+         MonitorNfpParserPreview(parser, &event);
+
+         parser->state = MONITOR_PARSER_MESSAGE_START;
+         goto post;
+      }
+   }
 
-   FwpsCopyStreamDataToBuffer(
-      streamBuffer,
-      stream,
-      streamLength,
-      &bytesCopied);
+   // The rest of the header is still to come, or the chain could not be mapped.
+   goto cleanup;
 
-   NT_ASSERT(bytesCopied == streamLength);
+post:
 
-   status = MonitorNfParseStreamAndTraceMessage(stream, streamLength, inbound, localPort, remotePort);
+   MonitorNfpTraceEvent(&event);
+   MonitorNfpPostEvent(&event);
 
-   ExFreePoolWithTag(stream, TAG_NAME_NOTIFY);
+cleanup:
 
    return status;
 }
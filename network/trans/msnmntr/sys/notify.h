@@ -23,10 +23,17 @@ MonitorNfInitialize(
 NTSTATUS
 MonitorNfUninitialize(void);
 
+NTSTATUS
+MonitorNfMapChannel(
+   _In_ WDFREQUEST request);
+
+NTSTATUS
+MonitorNfWaitChannel(
+   _In_ WDFREQUEST request);
+
 NTSTATUS MonitorNfNotifyMessage(
    _In_ const FWPS_STREAM_DATA* streamBuffer,
    _In_ BOOLEAN inbound,
-   _In_ USHORT localPort,
-   _In_ USHORT remotePort);
+   _Inout_ FLOW_DATA* flowData);
 
 
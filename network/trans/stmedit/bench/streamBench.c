@@ -0,0 +1,564 @@
+/*++
+
+Copyright (c) Microsoft Corporation. All rights reserved
+
+Abstract:
+
+    Stream Edit Callout Driver Sample.
+
+    A benchmark for scanning stream data in place.
+
+    It builds pattern_match.c and stream_scan.c from the sys directory, so
+    it runs the same matcher and chain walk the driver does, and drives
+    StreamScanDataInPlace with synthetic stream indications: text laid out
+    in NBL, NET_BUFFER and MDL chains shaped like TCP receives, receives
+    split over small MDLs, and large sends.  Each case is also run the way
+    the editors used to, copying the stream data out into a flat buffer
+    and scanning that, and the two are checked to stop at the same byte
+    with the same rule and the same matcher state.
+
+    Most streams never match, so the text is made free of matches; a
+    second run of each case puts a match in the last bytes, so that both
+    scan everything and then report it.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_code_)
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "streamBench.h"
+
+#define DEFAULT_MILLISECONDS    200
+
+#define MAX_STREAM_LENGTH       (1024 * 1024)
+#define MAX_NET_BUFFERS         (MAX_STREAM_LENGTH / 1460 + 1)
+#define MAX_MDLS                (MAX_STREAM_LENGTH / 256 + MAX_NET_BUFFERS)
+
+typedef NTSTATUS
+(*PSTREAM_SCAN_ROUTINE)(
+   const FWPS_STREAM_DATA* streamData,
+   size_t scanOffset,
+   _Inout_ PATTERN_MATCH_STATE* matchState,
+   _Out_ size_t* bytesScanned,
+   _Outptr_result_maybenull_ const PATTERN_MATCH_RULE** rule
+   );
+
+typedef struct BENCH_ROUTINE_
+{
+   PCSTR name;
+   PSTREAM_SCAN_ROUTINE routine;
+} BENCH_ROUTINE;
+
+typedef struct BENCH_LAYOUT_
+{
+   PCSTR name;
+   ULONG netBufferLength;
+   ULONG mdlLength;
+} BENCH_LAYOUT;
+
+typedef struct BENCH_RULE_SET_
+{
+   PCSTR name;
+   UINT count;
+   const char* find[16];
+} BENCH_RULE_SET;
+
+PATTERN_MATCHER gPatternMatcher;
+
+UINT8* gStreamBytes;
+UINT8* gFlatBuffer;
+
+MDL gMdls[MAX_MDLS];
+NET_BUFFER gNetBuffers[MAX_NET_BUFFERS];
+NET_BUFFER_LIST gNetBufferLists[MAX_NET_BUFFERS];
+
+LARGE_INTEGER gFrequency;
+
+MDL*
+BenchAllocateMdl(
+   _In_ PVOID virtualAddress,
+   ULONG length
+   )
+{
+   MDL* mdl = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(MDL));
+
+   if (mdl != NULL)
+   {
+      mdl->MappedSystemVa = virtualAddress;
+      mdl->ByteCount = length;
+   }
+
+   return mdl;
+}
+
+NTSTATUS
+StreamFlattenAndScan(
+   const FWPS_STREAM_DATA* streamData,
+   size_t scanOffset,
+   _Inout_ PATTERN_MATCH_STATE* matchState,
+   _Out_ size_t* bytesScanned,
+   _Outptr_result_maybenull_ const PATTERN_MATCH_RULE** rule
+   )
+/* ++
+
+   What the editors did before scanning in place: copy the whole stream
+   data out, as FwpsCopyStreamDataToBuffer does, and scan the copy.
+
+-- */
+{
+   NET_BUFFER_LIST* netBufferList = streamData->dataOffset.netBufferList;
+   NET_BUFFER* netBuffer = streamData->dataOffset.netBuffer;
+   MDL* mdl = streamData->dataOffset.mdl;
+   size_t mdlOffset = streamData->dataOffset.mdlOffset;
+   size_t netBufferRemaining = NET_BUFFER_DATA_LENGTH(netBuffer);
+   size_t copied = 0;
+   size_t scanned;
+
+   while (copied < streamData->dataLength)
+   {
+      size_t length;
+
+      if (netBufferRemaining == 0)
+      {
+         netBuffer = NET_BUFFER_NEXT_NB(netBuffer);
+
+         if (netBuffer == NULL)
+         {
+            netBufferList = NET_BUFFER_LIST_NEXT_NBL(netBufferList);
+            netBuffer = NET_BUFFER_LIST_FIRST_NB(netBufferList);
+         }
+
+         mdl = NET_BUFFER_CURRENT_MDL(netBuffer);
+         mdlOffset = NET_BUFFER_CURRENT_MDL_OFFSET(netBuffer);
+         netBufferRemaining = NET_BUFFER_DATA_LENGTH(netBuffer);
+
+         continue;
+      }
+
+      if (mdlOffset >= MmGetMdlByteCount(mdl))
+      {
+         mdl = mdl->Next;
+         mdlOffset = 0;
+
+         continue;
+      }
+
+      length = MmGetMdlByteCount(mdl) - mdlOffset;
+      length = min(length, netBufferRemaining);
+      length = min(length, streamData->dataLength - copied);
+
+      RtlCopyMemory(
+         gFlatBuffer + copied,
+         (UINT8*)MmGetSystemAddressForMdlSafe(mdl, NormalPagePriority) + mdlOffset,
+         length
+         );
+
+      copied += length;
+      mdlOffset += length;
+      netBufferRemaining -= length;
+   }
+
+   PatternMatcherScan(
+      &gPatternMatcher,
+      matchState,
+      gFlatBuffer + scanOffset,
+      streamData->dataLength - scanOffset,
+      &scanned,
+      rule
+      );
+
+   *bytesScanned = scanOffset + scanned;
+
+   return STATUS_SUCCESS;
+}
+
+//
+// The flattening scan comes first; it is the one the in-place scan is 
+// checked and compared against.
+//
+
+const BENCH_ROUTINE gRoutines[] =
+{
+   { "Flatten", StreamFlattenAndScan },
+   { "InPlace", StreamScanDataInPlace },
+};
+
+//
+// A TCP receive, one segment per NET_BUFFER in one MDL; the same split
+// over 256 byte MDLs, as some NICs indicate it; and a large send in page
+// sized MDLs.
+//
+
+const BENCH_LAYOUT gLayouts[] =
+{
+   { "rx",       1460, 1460 },
+   { "rx-frag",  1460,  256 },
+   { "tx",      65536, 4096 },
+};
+
+//
+// The driver's default rule, and a rule set as large as a product might
+// configure.
+//
+
+const BENCH_RULE_SET gRuleSets[] =
+{
+   { "1 rule", 1, { "rainy" } },
+   { "16 rules", 16,
+     { "rainy", "cloudy", "stormy", "windy", "foggy", "snowy", "hail", "sleet",
+       "drizzle", "thunder", "lightning", "tornado", "cyclone", "monsoon",
+       "blizzard", "hurricane" } },
+};
+
+const size_t gLengths[] = { 1460, 65536, MAX_STREAM_LENGTH };
+
+void
+BuildMatcher(
+   _In_ const BENCH_RULE_SET* ruleSet
+   )
+{
+   UINT i;
+
+   PatternMatcherCleanup(&gPatternMatcher);
+
+   for (i = 0; i < ruleSet->count; ++i)
+   {
+      PatternMatcherAddRule(
+         &gPatternMatcher,
+         ruleSet->find[i],
+         (UINT)strlen(ruleSet->find[i]),
+         "x",
+         1
+         );
+   }
+
+   PatternMatcherBuild(&gPatternMatcher);
+}
+
+void
+FillStream(
+   size_t length,
+   BOOLEAN matchAtEnd
+   )
+/* ++
+
+   Fills the stream with lower case text, which shares its bytes with the 
+   rules, then takes out every match, and optionally puts one in at the
+   end.
+
+-- */
+{
+   ULONG seed = 0x12345678;
+   PATTERN_MATCH_STATE state = 0;
+   const PATTERN_MATCH_RULE* rule;
+   size_t offset = 0;
+   size_t scanned;
+   size_t i;
+
+   for (i = 0; i < length; ++i)
+   {
+      seed = seed * 1664525 + 1013904223;
+      gStreamBytes[i] = (UINT8)("abcdefghijklmnopqrstuvwxyz  "[(seed >> 24) % 28]);
+   }
+
+   while (PatternMatcherScan(
+            &gPatternMatcher, 
+            &state, 
+            gStreamBytes + offset, 
+            length - offset, 
+            &scanned, 
+            &rule
+            ))
+   {
+      offset += scanned;
+      gStreamBytes[offset - 1] = ' ';
+      offset -= min(offset, (size_t)gPatternMatcher.maxFindLength);
+      state = 0;
+   }
+
+   if (matchAtEnd)
+   {
+      const PATTERN_MATCH_RULE* last = &gPatternMatcher.rules[gPatternMatcher.ruleCount - 1];
+
+      gStreamBytes[length - last->findLength - 1] = ' ';
+      RtlCopyMemory(gStreamBytes + length - last->findLength, last->find, last->findLength);
+   }
+}
+
+void
+BuildStreamData(
+   _Out_ FWPS_STREAM_DATA* streamData,
+   _In_ const BENCH_LAYOUT* layout,
+   size_t length
+   )
+/* ++
+
+   Lays the stream out in one NBL per NET_BUFFER, each NET_BUFFER in MDLs
+   of the layout's size.
+
+-- */
+{
+   size_t offset = 0;
+   ULONG nb = 0;
+   ULONG m = 0;
+
+   while (offset < length)
+   {
+      ULONG nbLength = (ULONG)min((size_t)layout->netBufferLength, length - offset);
+      ULONG nbOffset = 0;
+      MDL* previous = NULL;
+
+      while (nbOffset < nbLength)
+      {
+         gMdls[m].MappedSystemVa = gStreamBytes + offset + nbOffset;
+         gMdls[m].ByteCount = min(layout->mdlLength, nbLength - nbOffset);
+         gMdls[m].Next = NULL;
+
+         if (previous == NULL)
+         {
+            gNetBuffers[nb].CurrentMdl = &gMdls[m];
+         }
+         else
+         {
+            previous->Next = &gMdls[m];
+         }
+
+         previous = &gMdls[m];
+         nbOffset += gMdls[m].ByteCount;
+         ++m;
+      }
+
+      gNetBuffers[nb].Next = NULL;
+      gNetBuffers[nb].CurrentMdlOffset = 0;
+      gNetBuffers[nb].DataLength = nbLength;
+
+      gNetBufferLists[nb].FirstNetBuffer = &gNetBuffers[nb];
+      gNetBufferLists[nb].Next = NULL;
+
+      if (nb > 0)
+      {
+         gNetBufferLists[nb - 1].Next = &gNetBufferLists[nb];
+      }
+
+      offset += nbLength;
+      ++nb;
+   }
+
+   RtlZeroMemory(streamData, sizeof(FWPS_STREAM_DATA));
+
+   streamData->netBufferListChain = &gNetBufferLists[0];
+   streamData->dataOffset.netBufferList = &gNetBufferLists[0];
+   streamData->dataOffset.netBuffer = &gNetBuffers[0];
+   streamData->dataOffset.mdl = &gMdls[0];
+   streamData->dataOffset.mdlOffset = 0;
+   streamData->dataLength = length;
+}
+
+BOOLEAN
+CheckRoutine(
+   _In_ const BENCH_ROUTINE* routine,
+   _In_ const FWPS_STREAM_DATA* streamData
+   )
+{
+   PATTERN_MATCH_STATE expectedState = 0;
+   PATTERN_MATCH_STATE actualState = 0;
+   const PATTERN_MATCH_RULE* expectedRule;
+   const PATTERN_MATCH_RULE* actualRule;
+   size_t expectedScanned;
+   size_t actualScanned;
+
+   StreamFlattenAndScan(streamData, 0, &expectedState, &expectedScanned, &expectedRule);
+
+   if (!NT_SUCCESS(routine->routine(streamData, 0, &actualState, &actualScanned, &actualRule)))
+   {
+      return FALSE;
+   }
+
+   return (BOOLEAN)((expectedScanned == actualScanned) &&
+                    (expectedRule == actualRule) &&
+                    (expectedState == actualState));
+}
+
+double
+TimeRoutine(
+   _In_ const BENCH_ROUTINE* routine,
+   _In_ const FWPS_STREAM_DATA* streamData,
+   ULONG milliseconds
+   )
+/* ++
+
+   Returns the average time of one call in nanoseconds.
+
+-- */
+{
+   PATTERN_MATCH_STATE state;
+   const PATTERN_MATCH_RULE* rule;
+   size_t scanned;
+   LARGE_INTEGER start;
+   LARGE_INTEGER now;
+   LONGLONG budget;
+   ULONGLONG calls = 0;
+   ULONG i;
+
+   //
+   // Warm up the caches and the branch predictors.
+   //
+
+   for (i = 0; i < 16; ++i)
+   {
+      state = 0;
+      routine->routine(streamData, 0, &state, &scanned, &rule);
+   }
+
+   budget = gFrequency.QuadPart * milliseconds / 1000;
+
+   QueryPerformanceCounter(&start);
+
+   do
+   {
+      for (i = 0; i < 16; ++i)
+      {
+         state = 0;
+         routine->routine(streamData, 0, &state, &scanned, &rule);
+      }
+
+      calls += 16;
+
+      QueryPerformanceCounter(&now);
+
+   } while (now.QuadPart - start.QuadPart < budget);
+
+   return (double)(now.QuadPart - start.QuadPart) * 1e9 / (double)gFrequency.QuadPart / (double)calls;
+}
+
+void
+Usage(
+   void
+   )
+{
+   printf("Usage: streamBench [-Milliseconds <n>]\n");
+   printf("    -Milliseconds   time spent on each case (default %d)\n", DEFAULT_MILLISECONDS);
+}
+
+int
+__cdecl
+main(
+   _In_ int argc,
+   _In_reads_(argc) char* argv[]
+   )
+{
+   ULONG milliseconds = DEFAULT_MILLISECONDS;
+   FWPS_STREAM_DATA streamData;
+   int argument;
+   int failures = 0;
+   UINT s, l, n, m, r;
+   double baseline = 0.0;
+   double time;
+
+   for (argument = 1; argument < argc; ++argument)
+   {
+      if ((_stricmp(argv[argument], "-Milliseconds") == 0) && (argument + 1 < argc))
+      {
+         milliseconds = strtoul(argv[++argument], NULL, 0);
+      }
+      else
+      {
+         Usage();
+         return 1;
+      }
+   }
+
+   if (milliseconds == 0)
+   {
+      Usage();
+      return 1;
+   }
+
+   gStreamBytes = VirtualAlloc(NULL, MAX_STREAM_LENGTH, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+   gFlatBuffer = VirtualAlloc(NULL, MAX_STREAM_LENGTH, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+   if ((gStreamBytes == NULL) || (gFlatBuffer == NULL))
+   {
+      printf("Out of memory\n");
+      return 1;
+   }
+
+   QueryPerformanceFrequency(&gFrequency);
+
+   //
+   // Keep the timing thread on one processor and ahead of the rest of
+   // the system.
+   //
+
+   SetThreadAffinityMask(GetCurrentThread(), 1);
+   SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+
+   printf("%-8s %-9s %-8s %8s %-6s %12s %8s %8s\n",
+          "Routine", "Rules", "Layout", "Bytes", "Match", "ns/call", "GB/s", "vs flat");
+
+   for (s = 0; s < ARRAYSIZE(gRuleSets); ++s)
+   {
+      BuildMatcher(&gRuleSets[s]);
+
+      for (l = 0; l < ARRAYSIZE(gLayouts); ++l)
+      {
+         for (n = 0; n < ARRAYSIZE(gLengths); ++n)
+         {
+            for (m = 0; m < 2; ++m)
+            {
+               FillStream(gLengths[n], (BOOLEAN)m);
+               BuildStreamData(&streamData, &gLayouts[l], gLengths[n]);
+
+               for (r = 0; r < ARRAYSIZE(gRoutines); ++r)
+               {
+                  if ((r > 0) && !CheckRoutine(&gRoutines[r], &streamData))
+                  {
+                     printf("%-8s %-9s %-8s %8Iu %-6s    MISMATCH against the flattening scan\n",
+                            gRoutines[r].name, gRuleSets[s].name, gLayouts[l].name,
+                            gLengths[n], m ? "end" : "none");
+                     failures++;
+                     continue;
+                  }
+
+                  time = TimeRoutine(&gRoutines[r], &streamData, milliseconds);
+
+                  if (r == 0)
+                  {
+                     baseline = time;
+                  }
+
+                  printf("%-8s %-9s %-8s %8Iu %-6s %12.1f %8.2f %7.2fx\n",
+                         gRoutines[r].name,
+                         gRuleSets[s].name,
+                         gLayouts[l].name,
+                         gLengths[n],
+                         m ? "end" : "none",
+                         time,
+                         gLengths[n] / time,
+                         baseline / time);
+               }
+            }
+         }
+      }
+   }
+
+   PatternMatcherCleanup(&gPatternMatcher);
+
+   VirtualFree(gStreamBytes, 0, MEM_RELEASE);
+   VirtualFree(gFlatBuffer, 0, MEM_RELEASE);
+
+   if (failures != 0)
+   {
+      printf("\n%d routine checks failed\n", failures);
+      return 2;
+   }
+
+   return 0;
+}
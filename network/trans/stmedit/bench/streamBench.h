@@ -0,0 +1,124 @@
+/*++
+
+Copyright (c) Microsoft Corporation. All rights reserved
+
+Abstract:
+
+    Stream Edit Callout Driver Sample.
+
+    The parts of the kernel and WFP headers that pattern_match.c and
+    stream_scan.c use, for building them into the user mode benchmark.
+    The NBL, NET_BUFFER and MDL structures here only have the fields the
+    scan walks, and an MDL's system address is simply where its data is.
+
+    The declarations of the stmedit functions must be kept the same as in
+    stream_callout.h.
+
+Environment:
+
+    User mode
+
+--*/
+
+#ifndef _STREAM_BENCH_H
+#define _STREAM_BENCH_H
+
+#define WIN32_NO_STATUS
+#include <windows.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+
+typedef LONG NTSTATUS;
+
+#define NT_SUCCESS(Status) (((NTSTATUS)(Status)) >= 0)
+
+#define NT_ASSERT(exp)
+
+//
+// Pool and MDL routines used by pattern_match.c.
+//
+
+#define NonPagedPool 0
+
+#define ExAllocatePoolWithTag(_Type, _Size, _Tag) HeapAlloc(GetProcessHeap(), 0, (_Size))
+#define ExFreePoolWithTag(_Pool, _Tag) HeapFree(GetProcessHeap(), 0, (_Pool))
+
+typedef struct _MDL
+{
+   struct _MDL* Next;
+   PVOID MappedSystemVa;
+   ULONG ByteCount;
+} MDL, *PMDL;
+
+#define NormalPagePriority 16
+
+#define MmGetMdlByteCount(_Mdl) ((_Mdl)->ByteCount)
+#define MmGetSystemAddressForMdlSafe(_Mdl, _Priority) ((_Mdl)->MappedSystemVa)
+#define MmBuildMdlForNonPagedPool(_Mdl) ((void)(_Mdl))
+
+#define IoAllocateMdl(_Va, _Length, _SecondaryBuffer, _ChargeQuota, _Irp) \
+   BenchAllocateMdl((_Va), (_Length))
+#define IoFreeMdl(_Mdl) HeapFree(GetProcessHeap(), 0, (_Mdl))
+
+MDL*
+BenchAllocateMdl(
+   _In_ PVOID virtualAddress,
+   ULONG length
+   );
+
+//
+// The NBL/NET_BUFFER chains and the stream data of a WFP indication.
+//
+
+typedef struct _NET_BUFFER
+{
+   struct _NET_BUFFER* Next;
+   MDL* CurrentMdl;
+   ULONG CurrentMdlOffset;
+   ULONG DataLength;
+} NET_BUFFER;
+
+typedef struct _NET_BUFFER_LIST
+{
+   struct _NET_BUFFER_LIST* Next;
+   NET_BUFFER* FirstNetBuffer;
+} NET_BUFFER_LIST;
+
+#define NET_BUFFER_NEXT_NB(_NB) ((_NB)->Next)
+#define NET_BUFFER_CURRENT_MDL(_NB) ((_NB)->CurrentMdl)
+#define NET_BUFFER_CURRENT_MDL_OFFSET(_NB) ((_NB)->CurrentMdlOffset)
+#define NET_BUFFER_DATA_LENGTH(_NB) ((_NB)->DataLength)
+#define NET_BUFFER_LIST_NEXT_NBL(_NBL) ((_NBL)->Next)
+#define NET_BUFFER_LIST_FIRST_NB(_NBL) ((_NBL)->FirstNetBuffer)
+
+typedef struct FWPS_STREAM_DATA_OFFSET0_
+{
+   NET_BUFFER_LIST* netBufferList;
+   NET_BUFFER* netBuffer;
+   MDL* mdl;
+   SIZE_T mdlOffset;
+   SIZE_T streamDataOffset;
+} FWPS_STREAM_DATA_OFFSET;
+
+typedef struct FWPS_STREAM_DATA0_
+{
+   UINT32 flags;
+   FWPS_STREAM_DATA_OFFSET dataOffset;
+   SIZE_T dataLength;
+   NET_BUFFER_LIST* netBufferListChain;
+} FWPS_STREAM_DATA;
+
+#include "pattern_match.h"
+
+extern PATTERN_MATCHER gPatternMatcher;
+
+NTSTATUS
+StreamScanDataInPlace(
+   const FWPS_STREAM_DATA* streamData,
+   size_t scanOffset,
+   _Inout_ PATTERN_MATCH_STATE* matchState,
+   _Out_ size_t* bytesScanned,
+   _Outptr_result_maybenull_ const PATTERN_MATCH_RULE** rule
+   );
+
+#endif // _STREAM_BENCH_H
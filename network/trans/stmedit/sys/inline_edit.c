@@ -28,6 +28,7 @@ Environment:
 
 #include "inline_edit.h"
 #include "oob_edit.h"
+#include "pattern_match.h"
 #include "stream_callout.h"
 
 void
@@ -58,94 +59,23 @@ NTAPI StreamInjectCompletionFn(
    FwpsFreeNetBufferList(netBufferList);
 }
 
-NTSTATUS
-StreamEditFlushData(
-   _Inout_ STREAM_EDITOR* streamEditor,
-   UINT64 flowId,
-   UINT32 calloutId,
-   UINT16 layerId,
-   UINT32 streamFlags
+void
+StreamInlineEditPermit(
+   _In_ const FWPS_FILTER* filter,
+   size_t bytesToPermit,
+   _Inout_ FWPS_STREAM_CALLOUT_IO_PACKET* ioPacket,
+   _Inout_ FWPS_CLASSIFY_OUT* classifyOut
    )
-/* ++
-
-   This function re-injects buffered data back to the data stream upon
-   receiving a FIN. The data was buffered because it was not big enough
-   (size wise) to make an editing decision.
-
--- */
 {
-   NTSTATUS status;
-
-   MDL* mdl = NULL;
-   NET_BUFFER_LIST* netBufferList = NULL;
-
-   NT_ASSERT(streamEditor->dataOffset == 0);
-
-   mdl = IoAllocateMdl(
-            streamEditor->scratchBuffer,
-            (ULONG)(streamEditor->dataLength),
-            FALSE,
-            FALSE,
-            NULL
-            );
-
-   if (mdl == NULL)
-   {
-      status = STATUS_NO_MEMORY;
-      goto Exit;
-   }
-
-   MmBuildMdlForNonPagedPool(mdl);
+   ioPacket->streamAction = FWPS_STREAM_ACTION_NONE;
+   ioPacket->countBytesEnforced = bytesToPermit;
 
-   status = FwpsAllocateNetBufferAndNetBufferList(
-                  gNetBufferListPool,
-                  0,
-                  0,
-                  mdl,
-                  0,
-                  streamEditor->dataLength,
-                  &netBufferList
-                  );
-   if (!NT_SUCCESS(status))
-   {
-      goto Exit;
-   }
+   classifyOut->actionType = FWP_ACTION_PERMIT;
 
-   streamFlags &= ~(FWPS_STREAM_FLAG_SEND_DISCONNECT | FWPS_STREAM_FLAG_RECEIVE_DISCONNECT);
-
-   status = FwpsStreamInjectAsync(
-               gInjectionHandle,
-               NULL,
-               0,
-               flowId,
-               calloutId,
-               layerId,
-               streamFlags, 
-               netBufferList,
-               streamEditor->dataLength,
-               StreamInjectCompletionFn,
-               mdl
-               );
-   if (!NT_SUCCESS(status))
+   if (filter->flags & FWPS_FILTER_FLAG_CLEAR_ACTION_RIGHT)
    {
-      goto Exit;
+      classifyOut->rights &= ~FWPS_RIGHT_ACTION_WRITE;
    }
-
-   mdl = NULL;
-   netBufferList = NULL;
-
-Exit:
-
-   if (mdl != NULL)
-   {
-      IoFreeMdl(mdl);
-   }
-   if (netBufferList != NULL)
-   {
-      FwpsFreeNetBufferList(netBufferList);
-   }
-
-   return status;
 }
 
 void
@@ -164,80 +94,44 @@ StreamInlineEdit(
    and computes the number of bytes to permit, bytes to block, and 
    performs stream injection to replace the blocked data.
 
+   Data that could be the beginning of a match is never held by the 
+   editor; instead it is left at the end of the indication (by permitting
+   only the data in front of it) and FWPS_STREAM_ACTION_NEED_MORE_DATA is 
+   returned when it is all that remains. The matcher state reached at the 
+   end of that data is kept so that it is not scanned again when WFP 
+   indicates it along with the new data.
+
 -- */
 {
-   UINT findLength = (UINT) strlen(configStringToFind);
-   UINT replaceLength = (UINT) strlen(configStringToReplace);
+   const PATTERN_MATCH_RULE* rule;
+   size_t bytesScanned;
+   size_t pendingLength;
 
    if ((streamData->flags & FWPS_STREAM_FLAG_SEND_DISCONNECT) || 
        (streamData->flags & FWPS_STREAM_FLAG_RECEIVE_DISCONNECT))
    {
-      if (streamEditor->dataLength > 0)
-      {
-         StreamEditFlushData(
-            streamEditor,
-            inMetaValues->flowHandle,
-            filter->action.calloutId,
-            inFixedValues->layerId,
-            streamData->flags
-            );
-
-         streamEditor->dataLength = 0;
-         streamEditor->dataOffset = 0;
-      }
-
+      //
+      // Data deferred with NEED_MORE_DATA is indicated (with the no-more-data
+      // flag) ahead of the FIN, so nothing can be pending here.
+      //
       NT_ASSERT(streamEditor->inlineEditState == INLINE_EDIT_WAITING_FOR_DATA);
 
-      ioPacket->streamAction = FWPS_STREAM_ACTION_NONE;
-      classifyOut->actionType = FWP_ACTION_PERMIT;
-
-      if (filter->flags & FWPS_FILTER_FLAG_CLEAR_ACTION_RIGHT)
-      {
-         classifyOut->rights &= ~FWPS_RIGHT_ACTION_WRITE;
-      }
-
+      StreamInlineEditPermit(filter, 0, ioPacket, classifyOut);
       goto Exit;
    }
 
    if (streamData->dataLength == 0)
    {
-      ioPacket->streamAction = FWPS_STREAM_ACTION_NONE;
-      classifyOut->actionType = FWP_ACTION_PERMIT;
-
-      if (filter->flags & FWPS_FILTER_FLAG_CLEAR_ACTION_RIGHT)
-      {
-         classifyOut->rights &= ~FWPS_RIGHT_ACTION_WRITE;
-      }
-
+      StreamInlineEditPermit(filter, 0, ioPacket, classifyOut);
       goto Exit;
    }
 
-   if (streamEditor->inlineEditState != INLINE_EDIT_SKIPPING)
-   {
-      if ((streamData->dataLength < findLength) && 
-          !(classifyOut->flags & FWPS_CLASSIFY_OUT_FLAG_NO_MORE_DATA))
-      {
-         ioPacket->streamAction = FWPS_STREAM_ACTION_NEED_MORE_DATA;
-         ioPacket->countBytesRequired = findLength;
-
-         classifyOut->actionType = FWP_ACTION_NONE;
-         goto Exit;
-      }
-   }
-
    switch (streamEditor->inlineEditState)
    {
       case INLINE_EDIT_WAITING_FOR_DATA:
       {
-         if (StreamCopyDataForInspection(
-               streamEditor,
-               streamData
-               ) == FALSE)
-         {
-            ioPacket->streamAction = FWPS_STREAM_ACTION_DROP_CONNECTION;
-            classifyOut->actionType = FWP_ACTION_NONE;
-            goto Exit;
-         }
+         streamEditor->matchState = 0;
+         streamEditor->scannedLength = 0;
 
          //
          // Pass-thru to scanning
@@ -245,117 +139,102 @@ StreamInlineEdit(
       }
       case INLINE_EDIT_SCANNING:
       {
-         UINT i;
-         BYTE* dataStart =  (BYTE*)streamEditor->scratchBuffer + streamEditor->dataOffset;
-         BOOLEAN found = FALSE;
+         NTSTATUS status;
 
-         for (i = 0; i < streamEditor->dataLength; ++i)
-         {
-            if (i + findLength <= streamEditor->dataLength)
-            {
-               if (RtlCompareMemory(
-                     dataStart + i,
-                     configStringToFind,
-                     findLength
-                     ) == findLength)
-               {
-                  found = TRUE;
-
-                  streamEditor->inlineEditState = INLINE_EDIT_MODIFYING;
-
-                  if (i != 0)
-                  {
-                     ioPacket->streamAction = FWPS_STREAM_ACTION_NONE;
-                     ioPacket->countBytesEnforced = i;
-
-                     classifyOut->actionType = FWP_ACTION_PERMIT;
-
-                     if (filter->flags & FWPS_FILTER_FLAG_CLEAR_ACTION_RIGHT)
-                     {
-                        classifyOut->rights &= ~FWPS_RIGHT_ACTION_WRITE;
-                     }
-
-                     streamEditor->dataOffset += i;
-                     streamEditor->dataLength -= i;
-
-                     break;
-                  }
-                  else
-                  {
-                     goto modify_data;
-                  }
-               }
-            }
-            else
-            {
-               if (classifyOut->flags & FWPS_CLASSIFY_OUT_FLAG_NO_MORE_DATA)
-               {
-                  break;
-               }
-
-               if (RtlCompareMemory(
-                     dataStart + i,
-                     configStringToFind,
-                     streamEditor->dataLength - i
-                     ) == streamEditor->dataLength - i)
-               {
-                  found = TRUE;  // this is a partial find
-   
-                  ioPacket->streamAction = FWPS_STREAM_ACTION_NONE;
-                  ioPacket->countBytesEnforced = i;
-
-                  classifyOut->actionType = FWP_ACTION_PERMIT;
-
-                  if (filter->flags & FWPS_FILTER_FLAG_CLEAR_ACTION_RIGHT)
-                  {
-                     classifyOut->rights &= ~FWPS_RIGHT_ACTION_WRITE;
-                  }
-
-                  RtlMoveMemory(
-                     streamEditor->scratchBuffer,
-                     dataStart + i,
-                     streamEditor->dataLength - i
-                     );
+         NT_ASSERT(streamEditor->scannedLength <= streamData->dataLength);
 
-                  streamEditor->dataOffset = 0;
-                  streamEditor->dataLength = streamEditor->dataLength - i;
+         //
+         // The indicated data is scanned where it is; nothing is copied 
+         // since the editor only ever permits, blocks or injects 
+         // replacements.
+         //
+         status = StreamScanDataInPlace(
+                     streamData,
+                     streamEditor->scannedLength,
+                     &streamEditor->matchState,
+                     &bytesScanned,
+                     &rule
+                     );
 
-                  streamEditor->inlineEditState = INLINE_EDIT_SKIPPING;
-   
-                  break;
-               }
-            }
+         if (!NT_SUCCESS(status))
+         {
+            ioPacket->streamAction = FWPS_STREAM_ACTION_DROP_CONNECTION;
+            classifyOut->actionType = FWP_ACTION_NONE;
+            goto Exit;
          }
 
-         if (!found)
+         if (rule != NULL)
          {
-            ioPacket->streamAction = FWPS_STREAM_ACTION_NONE;
-            ioPacket->countBytesEnforced = 0;
+            size_t matchEnd = bytesScanned;
+
+            //
+            // Every byte of the match is part of this indication since none
+            // of it has been permitted yet.
+            //
+            NT_ASSERT(matchEnd >= rule->findLength);
 
-            classifyOut->actionType = FWP_ACTION_PERMIT;
+            streamEditor->matchRule = rule;
+            streamEditor->inlineEditState = INLINE_EDIT_MODIFYING;
 
-            if (filter->flags & FWPS_FILTER_FLAG_CLEAR_ACTION_RIGHT)
+            if (matchEnd != rule->findLength)
             {
-               classifyOut->rights &= ~FWPS_RIGHT_ACTION_WRITE;
+               //
+               // Permit the data in front of the match; the match will be 
+               // at the front of the next indication.
+               //
+               StreamInlineEditPermit(
+                  filter, 
+                  matchEnd - rule->findLength, 
+                  ioPacket, 
+                  classifyOut
+                  );
+               break;
+            }
+            else
+            {
+               goto modify_data;
             }
+         }
+
+         pendingLength = 
+            PatternMatcherPendingLength(&gPatternMatcher, streamEditor->matchState);
 
-            streamEditor->dataOffset = 0;
-            streamEditor->dataLength = 0;
+         if ((pendingLength == 0) || 
+             (classifyOut->flags & FWPS_CLASSIFY_OUT_FLAG_NO_MORE_DATA))
+         {
+            StreamInlineEditPermit(filter, 0, ioPacket, classifyOut);
 
             streamEditor->inlineEditState = INLINE_EDIT_WAITING_FOR_DATA;
          }
+         else if (pendingLength < streamData->dataLength)
+         {
+            //
+            // Permit everything in front of the potential match; the rest
+            // will be indicated again right away and has been scanned.
+            //
+            StreamInlineEditPermit(
+               filter, 
+               streamData->dataLength - pendingLength, 
+               ioPacket, 
+               classifyOut
+               );
 
-         break;
-      }
-      case INLINE_EDIT_SKIPPING:
-      {
-         ioPacket->streamAction = FWPS_STREAM_ACTION_NONE;
-         ioPacket->countBytesEnforced = 0;
+            streamEditor->scannedLength = pendingLength;
+            streamEditor->inlineEditState = INLINE_EDIT_SCANNING;
+         }
+         else
+         {
+            //
+            // The whole indication could be the beginning of a match.
+            //
+            ioPacket->streamAction = FWPS_STREAM_ACTION_NEED_MORE_DATA;
+            ioPacket->countBytesRequired = streamData->dataLength + 1;
 
-         classifyOut->actionType = FWP_ACTION_BLOCK;
-         classifyOut->rights &= ~FWPS_RIGHT_ACTION_WRITE;
+            classifyOut->actionType = FWP_ACTION_NONE;
 
-         streamEditor->inlineEditState = INLINE_EDIT_WAITING_FOR_DATA;
+            streamEditor->scannedLength = streamData->dataLength;
+            streamEditor->inlineEditState = INLINE_EDIT_SCANNING;
+         }
 
          break;
       }
@@ -367,13 +246,17 @@ modify_data:
          NTSTATUS status;
          NET_BUFFER_LIST* netBufferList;
 
+         rule = streamEditor->matchRule;
+         NT_ASSERT(rule != NULL);
+         NT_ASSERT(streamData->dataLength >= rule->findLength);
+
          status = FwpsAllocateNetBufferAndNetBufferList(
                      gNetBufferListPool,
                      0,
                      0,
-                     gStringToReplaceMdl,
+                     rule->replaceMdl,
                      0,
-                     replaceLength,
+                     rule->replaceLength,
                      &netBufferList
                      );
 
@@ -393,7 +276,7 @@ modify_data:
                      inFixedValues->layerId,
                      streamData->flags,
                      netBufferList,
-                     replaceLength,
+                     rule->replaceLength,
                      StreamInjectCompletionFn,
                      NULL
                      );
@@ -408,24 +291,17 @@ modify_data:
          }
 
          ioPacket->streamAction = FWPS_STREAM_ACTION_NONE;
-         ioPacket->countBytesEnforced = findLength;
+         ioPacket->countBytesEnforced = rule->findLength;
 
          classifyOut->actionType = FWP_ACTION_BLOCK;
          classifyOut->rights &= ~FWPS_RIGHT_ACTION_WRITE;
 
-         streamEditor->dataOffset += findLength;
-         streamEditor->dataLength -= findLength;
-
-         if (streamEditor->dataLength > 0)
-         {
-            streamEditor->inlineEditState = INLINE_EDIT_SCANNING;
-         }
-         else
-         {
-            streamEditor->dataOffset = 0;
-
-            streamEditor->inlineEditState = INLINE_EDIT_WAITING_FOR_DATA;
-         }
+         //
+         // Data following the match (if any) is indicated next and scanned
+         // from the initial matcher state.
+         //
+         streamEditor->matchRule = NULL;
+         streamEditor->inlineEditState = INLINE_EDIT_WAITING_FOR_DATA;
 
          break;
       }
@@ -21,7 +21,6 @@ Environment:
 typedef enum INLINE_EDIT_STATE_
 {
    INLINE_EDIT_WAITING_FOR_DATA,
-   INLINE_EDIT_SKIPPING,
    INLINE_EDIT_MODIFYING,
    INLINE_EDIT_SCANNING
 } INLINE_EDIT_STATE;
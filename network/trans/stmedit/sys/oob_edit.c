@@ -28,6 +28,7 @@ Environment:
 
 #include "inline_edit.h"
 #include "oob_edit.h"
+#include "pattern_match.h"
 #include "stream_callout.h"
 
 #define STREAM_EDITOR_OUTGOING_DATA_TAG 'doeS'
@@ -795,6 +796,36 @@ Exit:
    return status;
 }
 
+__inline
+void
+StreamOobInitStreamData(
+   _Out_ FWPS_STREAM_DATA* streamData,
+   _In_ NET_BUFFER_LIST* netBufferListChain,
+   size_t totalDataLength,
+   DWORD streamFlags
+   )
+/* ++
+
+   This function creates a FWPS_STREAM_DATA struct that describes the data
+   of an NBL chain (cloned via FwpsCloneStreamData) from its beginning.
+
+-- */
+{
+   RtlZeroMemory(streamData, sizeof(FWPS_STREAM_DATA));
+
+   streamData->netBufferListChain = netBufferListChain;
+   streamData->dataLength =  totalDataLength;
+   streamData->flags = streamFlags;
+
+   streamData->dataOffset.netBufferList = netBufferListChain;
+   streamData->dataOffset.netBuffer = 
+      NET_BUFFER_LIST_FIRST_NB(streamData->dataOffset.netBufferList);
+   streamData->dataOffset.mdl = 
+      NET_BUFFER_CURRENT_MDL(streamData->dataOffset.netBuffer);
+   streamData->dataOffset.mdlOffset = 
+      NET_BUFFER_CURRENT_MDL_OFFSET(streamData->dataOffset.netBuffer);
+}
+
 NTSTATUS
 StreamOobCopyDataToFlatBuffer(
    _Inout_ STREAM_EDITOR* streamEditor,
@@ -813,21 +844,16 @@ StreamOobCopyDataToFlatBuffer(
 {
    NTSTATUS status = STATUS_SUCCESS;
 
-   FWPS_STREAM_DATA streamData = {0};
+   FWPS_STREAM_DATA streamData;
 
    if (totalDataLength > 0)
    {
-      streamData.netBufferListChain = netBufferListChain;
-      streamData.dataLength =  totalDataLength;
-      streamData.flags = streamFlags;
-
-      streamData.dataOffset.netBufferList = netBufferListChain;
-      streamData.dataOffset.netBuffer = 
-         NET_BUFFER_LIST_FIRST_NB(streamData.dataOffset.netBufferList);
-      streamData.dataOffset.mdl = 
-         NET_BUFFER_CURRENT_MDL(streamData.dataOffset.netBuffer);
-      streamData.dataOffset.mdlOffset = 
-         NET_BUFFER_CURRENT_MDL_OFFSET(streamData.dataOffset.netBuffer);
+      StreamOobInitStreamData(
+         &streamData,
+         netBufferListChain,
+         totalDataLength,
+         streamFlags
+         );
 
       if (StreamCopyDataForInspection(
             streamEditor,
@@ -850,14 +876,19 @@ StreamOobEditData(
    )
 /* ++
 
-   This function first copies the stream data into a flat inspection buffer;
-   it then parses the buffer looking for the matching pattern. For
-   non-matching sections it re-injects the data back; for a match it skips 
-   over and injects an replacement section.
+   This function first runs the pattern matcher over the cloned NBL chain
+   in place. If the data neither contains a match nor ends in a potential 
+   match (the common case) the clones are re-injected as they are.
+
+   Otherwise it copies the stream data into a flat inspection buffer and 
+   runs the matcher over the buffer again. For non-matching sections it 
+   re-injects the data back; for a match it skips over and injects the 
+   replacement section of the matching rule.
 
    If a match can not be determined due to lack of data, it injects the
    non-matching section back and moves the potential match to the beginning
-   of the inspection buffer.
+   of the inspection buffer. The matcher state is kept in the editor so 
+   that the potential match is not scanned again on the next pass.
 
    When an EOF is reached, it flushes all processed stream sections back
    and re-injects the FIN back to end the stream.
@@ -866,149 +897,74 @@ StreamOobEditData(
 {
    NTSTATUS status = STATUS_SUCCESS;
 
-   UINT i = 0;
-   BOOLEAN streamModified = FALSE;
-   BOOLEAN potentialMatch = FALSE;
+   const PATTERN_MATCH_RULE* rule;
+   size_t bytesScanned;
+   size_t pendingLength;
 
    BYTE* dataStart;
 
-   UINT findLength = (UINT) strlen(configStringToFind);
+   //
+   // Data carried over from the previous pass (a potential match) has been 
+   // scanned already; the matcher resumes right after it.
+   //
+   size_t carriedLength = streamEditor->dataLength;
+   size_t scanOffset = carriedLength;
+   PATTERN_MATCH_STATE initialMatchState = streamEditor->matchState;
 
-   status = StreamOobCopyDataToFlatBuffer(
-               streamEditor,
-               netBufferListChain,
-               totalDataLength,
-               streamFlags
-               );
-   if (!NT_SUCCESS(status))
-   {
-      goto Exit;
-   }
-    
-   dataStart =  (BYTE*)streamEditor->scratchBuffer + streamEditor->dataOffset;
+   rule = NULL;
 
-   for (; i < streamEditor->dataLength; ++i)
+   if (totalDataLength > 0)
    {
-      if (i + findLength <= streamEditor->dataLength)
-      {
-         if (RtlCompareMemory(
-               dataStart + i,
-               configStringToFind,
-               findLength
-               ) == findLength)
-         {
-            if (i != 0)
-            {
-               status = StreamOobReinjectData(
-                              streamEditor,
-                              streamFlags, 
-                              dataStart,
-                              i
-                              );
-
-               if (!NT_SUCCESS(status))
-               {
-                  goto Exit;
-               }
-
-               streamEditor->dataOffset += i;
-               streamEditor->dataLength -= i;
-
-               i = 0;
-            }
-
-            status = StreamOobInjectReplacement(
-                        streamEditor,
-                        streamFlags, 
-                        gStringToReplaceMdl,
-                        strlen(configStringToReplace)
-                        );
+      FWPS_STREAM_DATA streamData;
 
-            if (!NT_SUCCESS(status))
-            {
-               goto Exit;
-            }
-
-            streamEditor->dataOffset += findLength;
-            streamEditor->dataLength -= findLength;
-
-            streamModified = TRUE;
-
-            if (streamEditor->dataLength > 0)
-            {
-               dataStart =  (BYTE*)streamEditor->scratchBuffer + streamEditor->dataOffset;
+      StreamOobInitStreamData(
+         &streamData,
+         netBufferListChain,
+         totalDataLength,
+         streamFlags
+         );
 
-               --i;               
+      status = StreamScanDataInPlace(
+                  &streamData,
+                  0,
+                  &streamEditor->matchState,
+                  &bytesScanned,
+                  &rule
+                  );
 
-               continue;
-            }
-            else
-            {
-               streamEditor->dataOffset = 0;
-            }
-         }
-      }
-      else
+      if (!NT_SUCCESS(status))
       {
-         if (streamEditor->oobEditInfo.noMoreData)
-         {
-            break;
-         }
-
-         if (RtlCompareMemory(
-               dataStart + i,
-               configStringToFind,
-               streamEditor->dataLength - i
-               ) == streamEditor->dataLength - i)
-         {
-            potentialMatch = TRUE;  // this is a partial find
-
-            status = StreamOobReinjectData(
-                           streamEditor,
-                           streamFlags, 
-                           dataStart,
-                           i
-                           );
-
-            if (!NT_SUCCESS(status))
-            {
-               goto Exit;
-            }
-
-            RtlMoveMemory(
-               (BYTE*)streamEditor->scratchBuffer,
-               dataStart + i,
-               streamEditor->dataLength - i
-               );
-
-            streamEditor->dataOffset = 0;
-            streamEditor->dataLength = streamEditor->dataLength - i;
-
-            break;
-         }
+         goto Exit;
       }
    }
 
-   if (streamModified && streamEditor->dataLength > 0)
+   if ((rule == NULL) && 
+       (streamEditor->oobEditInfo.noMoreData ||
+        (PatternMatcherPendingLength(
+            &gPatternMatcher, 
+            streamEditor->matchState) == 0)))
    {
-      status = StreamOobReinjectData(
-                     streamEditor,
-                     streamFlags, 
-                     dataStart,
-                     streamEditor->dataLength
-                     );
+      dataStart = (BYTE*)streamEditor->scratchBuffer + streamEditor->dataOffset;
 
-      if (!NT_SUCCESS(status))
+      //
+      // Nothing to edit -- the carried-over data is re-injected from the
+      // inspection buffer and the indicated data as the original clones.
+      //
+      if (carriedLength > 0)
       {
-         goto Exit;
-      }
+         status = StreamOobReinjectData(
+                        streamEditor,
+                        streamFlags, 
+                        dataStart,
+                        carriedLength
+                        );
 
-      streamEditor->dataOffset = 0;
-      streamEditor->dataLength = 0;
-   }
+         if (!NT_SUCCESS(status))
+         {
+            goto Exit;
+         }
+      }
 
-   if (!streamModified && !potentialMatch)
-   {
       if (totalDataLength > 0)
       {
          NT_ASSERT(!(streamFlags & FWPS_STREAM_FLAG_SEND_DISCONNECT) && 
@@ -1030,13 +986,53 @@ StreamOobEditData(
 
          netBufferListChain = NULL;
       }
-      else if (streamEditor->dataLength > 0)
+
+      streamEditor->matchState = 0;
+      streamEditor->dataOffset = 0;
+      streamEditor->dataLength = 0;
+
+      goto Eof;
+   }
+
+   //
+   // The data has to be edited or partially held back; flatten it and scan
+   // it again from where the pass started.
+   //
+   streamEditor->matchState = initialMatchState;
+
+   status = StreamOobCopyDataToFlatBuffer(
+               streamEditor,
+               netBufferListChain,
+               totalDataLength,
+               streamFlags
+               );
+   if (!NT_SUCCESS(status))
+   {
+      goto Exit;
+   }
+    
+   dataStart =  (BYTE*)streamEditor->scratchBuffer + streamEditor->dataOffset;
+
+   while (PatternMatcherScan(
+            &gPatternMatcher,
+            &streamEditor->matchState,
+            dataStart + scanOffset,
+            streamEditor->dataLength - scanOffset,
+            &bytesScanned,
+            &rule
+            ))
+   {
+      size_t matchEnd = scanOffset + bytesScanned;
+
+      NT_ASSERT(matchEnd >= rule->findLength);
+
+      if (matchEnd != rule->findLength)
       {
          status = StreamOobReinjectData(
                         streamEditor,
                         streamFlags, 
                         dataStart,
-                        streamEditor->dataLength
+                        matchEnd - rule->findLength
                         );
 
          if (!NT_SUCCESS(status))
@@ -1045,10 +1041,69 @@ StreamOobEditData(
          }
       }
 
-      streamEditor->dataOffset = 0;
-      streamEditor->dataLength = 0;
+      status = StreamOobInjectReplacement(
+                  streamEditor,
+                  streamFlags, 
+                  rule->replaceMdl,
+                  rule->replaceLength
+                  );
+
+      if (!NT_SUCCESS(status))
+      {
+         goto Exit;
+      }
+
+      streamEditor->dataOffset += matchEnd;
+      streamEditor->dataLength -= matchEnd;
+
+      dataStart += matchEnd;
+      scanOffset = 0;
+   }
+
+   if (streamEditor->oobEditInfo.noMoreData)
+   {
+      pendingLength = 0;
+      streamEditor->matchState = 0;
+   }
+   else
+   {
+      pendingLength = 
+         PatternMatcherPendingLength(&gPatternMatcher, streamEditor->matchState);
+   }
+
+   if (streamEditor->dataLength > pendingLength)
+   {
+      status = StreamOobReinjectData(
+                     streamEditor,
+                     streamFlags, 
+                     dataStart,
+                     streamEditor->dataLength - pendingLength
+                     );
+
+      if (!NT_SUCCESS(status))
+      {
+         goto Exit;
+      }
+   }
+
+   //
+   // Move the potential match (if any) to the beginning of the inspection 
+   // buffer; it is scanned no further until more data arrives.
+   //
+   if (pendingLength > 0)
+   {
+      RtlMoveMemory(
+         (BYTE*)streamEditor->scratchBuffer,
+         dataStart + streamEditor->dataLength - pendingLength,
+         pendingLength
+         );
    }
 
+   streamEditor->dataOffset = 0;
+   streamEditor->dataLength = pendingLength;
+
+Eof:
+
    if (streamEditor->oobEditInfo.nblEof != NULL)
    {
       status = StreamOobFlushOutgoingData(streamEditor);
@@ -1271,7 +1326,7 @@ StreamOobEditClassify(
    FWPS_STREAM_CALLOUT_IO_PACKET* ioPacket;
    FWPS_STREAM_DATA* streamData;
 
-   UINT findLength = (UINT) strlen(configStringToFind);
+   UINT findLength = gPatternMatcher.minFindLength;
 
    ioPacket = (FWPS_STREAM_CALLOUT_IO_PACKET*)layerData;
    NT_ASSERT(ioPacket != NULL);
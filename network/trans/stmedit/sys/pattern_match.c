@@ -0,0 +1,403 @@
+/*++
+
+Copyright (c) Microsoft Corporation. All rights reserved
+
+Abstract:
+
+    Stream Edit Callout Driver Sample.
+    
+    This file implements the multi-pattern matcher used by the stream 
+    editors. The find strings of all rules are compiled into a single 
+    Aho-Corasick automaton during DriverEntry; scanning then costs one table 
+    lookup per byte regardless of the number of rules, and the scan can be 
+    suspended after any byte and resumed with the next data segment.
+
+    A match is reported as soon as its last byte is scanned; if several 
+    rules match at that position the longest one wins. Matches do not 
+    overlap -- scanning resumes from the initial state after a match.
+
+    The file is also built into the user mode benchmark in the bench 
+    directory; bench\streamBench.h stands in for ntddk.h there.
+
+Environment:
+
+    Kernel & user mode
+
+--*/
+
+#if defined(_KERNEL_MODE)
+#include <ntddk.h>
+#else
+#include "streamBench.h"
+#endif
+
+#include "pattern_match.h"
+
+#define STREAM_EDITOR_RULE_TAG 'rmeS'
+#define STREAM_EDITOR_AUTOMATON_TAG 'ameS'
+
+#define PATTERN_MATCH_NO_STATE ((UINT16)-1)
+
+NTSTATUS
+PatternMatcherAddRule(
+   _Inout_ PATTERN_MATCHER* matcher,
+   _In_reads_bytes_(findLength) const void* find,
+   UINT findLength,
+   _In_reads_bytes_(replaceLength) const void* replace,
+   UINT replaceLength
+   )
+/* ++
+
+   This function adds a find/replace rule to the matcher. The strings are
+   copied into a non-paged allocation and an MDL is built to describe the
+   replacement for injection.
+
+   Rules can only be added before PatternMatcherBuild is called.
+
+-- */
+{
+   NTSTATUS status = STATUS_SUCCESS;
+
+   PATTERN_MATCH_RULE* rule;
+   UINT8* buffer = NULL;
+
+   NT_ASSERT(matcher->transitions == NULL);
+
+   if ((matcher->ruleCount == PATTERN_MATCH_MAX_RULES) ||
+       (findLength == 0) || 
+       (findLength > PATTERN_MATCH_MAX_FIND_LENGTH) ||
+       (replaceLength == 0))
+   {
+      status = STATUS_INVALID_PARAMETER;
+      goto Exit;
+   }
+
+   buffer = ExAllocatePoolWithTag(
+               NonPagedPool,
+               findLength + replaceLength,
+               STREAM_EDITOR_RULE_TAG
+               );
+
+   if (buffer == NULL)
+   {
+      status = STATUS_NO_MEMORY;
+      goto Exit;
+   }
+
+   rule = &matcher->rules[matcher->ruleCount];
+
+   rule->find = buffer;
+   rule->findLength = findLength;
+   RtlCopyMemory(rule->find, find, findLength);
+
+   rule->replace = buffer + findLength;
+   rule->replaceLength = replaceLength;
+   RtlCopyMemory(rule->replace, replace, replaceLength);
+
+   rule->replaceMdl = IoAllocateMdl(
+                        rule->replace,
+                        replaceLength,
+                        FALSE,
+                        FALSE,
+                        NULL
+                        );
+
+   if (rule->replaceMdl == NULL)
+   {
+      RtlZeroMemory(rule, sizeof(PATTERN_MATCH_RULE));
+
+      status = STATUS_NO_MEMORY;
+      goto Exit;
+   }
+
+   MmBuildMdlForNonPagedPool(rule->replaceMdl);
+
+   buffer = NULL; // ownership transferred to the rule
+
+   if ((matcher->ruleCount == 0) || (findLength < matcher->minFindLength))
+   {
+      matcher->minFindLength = findLength;
+   }
+   if (findLength > matcher->maxFindLength)
+   {
+      matcher->maxFindLength = findLength;
+   }
+
+   matcher->ruleCount++;
+
+Exit:
+
+   if (buffer != NULL)
+   {
+      ExFreePoolWithTag(buffer, STREAM_EDITOR_RULE_TAG);
+   }
+
+   return status;
+}
+
+NTSTATUS
+PatternMatcherBuild(
+   _Inout_ PATTERN_MATCHER* matcher
+   )
+/* ++
+
+   This function compiles the rules into a DFA. A trie of the find strings
+   is built first; a breadth-first pass then computes the failure link 
+   of every state and fills in the missing transitions from the state's 
+   failure state, whose row is already complete since it is shallower.
+
+-- */
+{
+   NTSTATUS status = STATUS_SUCCESS;
+
+   UINT16* failure = NULL;
+   UINT16* queue = NULL;
+   UINT maxStates = 1;
+   UINT head = 0;
+   UINT tail = 0;
+   UINT i;
+   UINT j;
+
+   NT_ASSERT(matcher->transitions == NULL);
+
+   if (matcher->ruleCount == 0)
+   {
+      status = STATUS_INVALID_PARAMETER;
+      goto Exit;
+   }
+
+   RtlZeroMemory(matcher->byteClass, sizeof(matcher->byteClass));
+   matcher->classCount = 1;
+
+   for (i = 0; i < matcher->ruleCount; ++i)
+   {
+      for (j = 0; j < matcher->rules[i].findLength; ++j)
+      {
+         UINT8 byte = matcher->rules[i].find[j];
+
+         if (matcher->byteClass[byte] == 0)
+         {
+            matcher->byteClass[byte] = (UINT16)matcher->classCount++;
+         }
+      }
+
+      maxStates += matcher->rules[i].findLength;
+   }
+
+   //
+   // Bounded by PATTERN_MATCH_MAX_RULES * PATTERN_MATCH_MAX_FIND_LENGTH so
+   // that a state always fits in (and never collides with) 
+   // PATTERN_MATCH_NO_STATE.
+   //
+   NT_ASSERT(maxStates < PATTERN_MATCH_NO_STATE);
+
+   matcher->transitions = ExAllocatePoolWithTag(
+                              NonPagedPool,
+                              maxStates * matcher->classCount * sizeof(UINT16),
+                              STREAM_EDITOR_AUTOMATON_TAG
+                              );
+   matcher->depth = ExAllocatePoolWithTag(
+                        NonPagedPool,
+                        maxStates * sizeof(UINT16),
+                        STREAM_EDITOR_AUTOMATON_TAG
+                        );
+   matcher->match = ExAllocatePoolWithTag(
+                        NonPagedPool,
+                        maxStates * sizeof(UINT8),
+                        STREAM_EDITOR_AUTOMATON_TAG
+                        );
+   failure = ExAllocatePoolWithTag(
+               NonPagedPool,
+               maxStates * sizeof(UINT16),
+               STREAM_EDITOR_AUTOMATON_TAG
+               );
+   queue = ExAllocatePoolWithTag(
+               NonPagedPool,
+               maxStates * sizeof(UINT16),
+               STREAM_EDITOR_AUTOMATON_TAG
+               );
+
+   if ((matcher->transitions == NULL) || (matcher->depth == NULL) ||
+       (matcher->match == NULL) || (failure == NULL) || (queue == NULL))
+   {
+      status = STATUS_NO_MEMORY;
+      goto Exit;
+   }
+
+   RtlFillMemory(
+      matcher->transitions,
+      maxStates * matcher->classCount * sizeof(UINT16),
+      0xFF
+      );
+   RtlZeroMemory(matcher->depth, maxStates * sizeof(UINT16));
+   RtlZeroMemory(matcher->match, maxStates * sizeof(UINT8));
+
+   //
+   // Build the trie. If two rules share a find string the first one wins.
+   //
+
+   matcher->stateCount = 1;
+
+   for (i = 0; i < matcher->ruleCount; ++i)
+   {
+      UINT16 state = 0;
+
+      for (j = 0; j < matcher->rules[i].findLength; ++j)
+      {
+         UINT16* next = 
+            &matcher->transitions[state * matcher->classCount + 
+                                  matcher->byteClass[matcher->rules[i].find[j]]];
+
+         if (*next == PATTERN_MATCH_NO_STATE)
+         {
+            *next = (UINT16)matcher->stateCount++;
+            matcher->depth[*next] = matcher->depth[state] + 1;
+         }
+
+         state = *next;
+      }
+
+      if (matcher->match[state] == 0)
+      {
+         matcher->match[state] = (UINT8)(i + 1);
+      }
+   }
+
+   //
+   // Children of the initial state fail back to it; any other byte loops
+   // on it.
+   //
+
+   for (j = 0; j < matcher->classCount; ++j)
+   {
+      UINT16 next = matcher->transitions[j];
+
+      if (next == PATTERN_MATCH_NO_STATE)
+      {
+         matcher->transitions[j] = 0;
+      }
+      else
+      {
+         failure[next] = 0;
+         queue[tail++] = next;
+      }
+   }
+
+   while (head < tail)
+   {
+      UINT16 state = queue[head++];
+      UINT16* row = &matcher->transitions[state * matcher->classCount];
+      const UINT16* failureRow = 
+         &matcher->transitions[failure[state] * matcher->classCount];
+
+      //
+      // A state without a match of its own reports the (shorter) match of
+      // its failure state, which ends at the same byte.
+      //
+      if (matcher->match[state] == 0)
+      {
+         matcher->match[state] = matcher->match[failure[state]];
+      }
+
+      for (j = 0; j < matcher->classCount; ++j)
+      {
+         if (row[j] == PATTERN_MATCH_NO_STATE)
+         {
+            row[j] = failureRow[j];
+         }
+         else
+         {
+            failure[row[j]] = failureRow[j];
+            queue[tail++] = row[j];
+         }
+      }
+   }
+
+Exit:
+
+   if (queue != NULL)
+   {
+      ExFreePoolWithTag(queue, STREAM_EDITOR_AUTOMATON_TAG);
+   }
+   if (failure != NULL)
+   {
+      ExFreePoolWithTag(failure, STREAM_EDITOR_AUTOMATON_TAG);
+   }
+
+   return status;
+}
+
+void
+PatternMatcherCleanup(
+   _Inout_ PATTERN_MATCHER* matcher
+   )
+{
+   UINT i;
+
+   for (i = 0; i < matcher->ruleCount; ++i)
+   {
+      IoFreeMdl(matcher->rules[i].replaceMdl);
+      ExFreePoolWithTag(matcher->rules[i].find, STREAM_EDITOR_RULE_TAG);
+   }
+
+   if (matcher->transitions != NULL)
+   {
+      ExFreePoolWithTag(matcher->transitions, STREAM_EDITOR_AUTOMATON_TAG);
+   }
+   if (matcher->depth != NULL)
+   {
+      ExFreePoolWithTag(matcher->depth, STREAM_EDITOR_AUTOMATON_TAG);
+   }
+   if (matcher->match != NULL)
+   {
+      ExFreePoolWithTag(matcher->match, STREAM_EDITOR_AUTOMATON_TAG);
+   }
+
+   RtlZeroMemory(matcher, sizeof(PATTERN_MATCHER));
+}
+
+BOOLEAN
+PatternMatcherScan(
+   _In_ const PATTERN_MATCHER* matcher,
+   _Inout_ PATTERN_MATCH_STATE* state,
+   _In_reads_bytes_(length) const void* data,
+   size_t length,
+   _Out_ size_t* bytesScanned,
+   _Outptr_result_maybenull_ const PATTERN_MATCH_RULE** rule
+   )
+/* ++
+
+   This function runs the automaton over a data segment starting from 
+   *state. It stops at the first byte that completes a match, in which case
+   *bytesScanned includes that byte, *rule is the matching rule and *state 
+   is reset. Otherwise the whole segment is consumed and *state records 
+   where to resume with the next segment.
+
+-- */
+{
+   const UINT8* bytes = (const UINT8*)data;
+   const UINT16* transitions = matcher->transitions;
+   UINT classCount = matcher->classCount;
+   UINT current = *state;
+   size_t i;
+
+   for (i = 0; i < length; ++i)
+   {
+      current = transitions[current * classCount + matcher->byteClass[bytes[i]]];
+
+      if (matcher->match[current] != 0)
+      {
+         *rule = &matcher->rules[matcher->match[current] - 1];
+         *bytesScanned = i + 1;
+         *state = 0;
+
+         return TRUE;
+      }
+   }
+
+   *rule = NULL;
+   *bytesScanned = length;
+   *state = (PATTERN_MATCH_STATE)current;
+
+   return FALSE;
+}
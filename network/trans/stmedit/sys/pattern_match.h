@@ -0,0 +1,114 @@
+/*++
+
+Copyright (c) Microsoft Corporation. All rights reserved
+
+Abstract:
+
+    Stream Edit Callout Driver Sample.
+    
+    This file declares the multi-pattern (Aho-Corasick) matcher used by both
+    the inline and the out-of-band stream editors.
+
+Environment:
+
+    Kernel mode
+
+--*/
+
+#ifndef _PATTERN_MATCH_H
+#define _PATTERN_MATCH_H
+
+#define PATTERN_MATCH_MAX_RULES 64
+#define PATTERN_MATCH_MAX_FIND_LENGTH 127
+
+//
+// A find/replace pair. The replacement is described by an MDL so that it
+// can be injected into the stream as is.
+//
+
+typedef struct PATTERN_MATCH_RULE_
+{
+   UINT8* find;
+   UINT findLength;
+
+   UINT8* replace;
+   UINT replaceLength;
+   MDL* replaceMdl;
+} PATTERN_MATCH_RULE;
+
+//
+// The per-stream matcher state; it is the automaton state reached after the 
+// last byte scanned and is all that needs to be kept across data segments.
+//
+
+typedef UINT16 PATTERN_MATCH_STATE;
+
+typedef struct PATTERN_MATCHER_
+{
+   UINT ruleCount;
+   PATTERN_MATCH_RULE rules[PATTERN_MATCH_MAX_RULES];
+
+   UINT minFindLength;
+   UINT maxFindLength;
+
+   //
+   // The automaton is a dense DFA. Bytes that appear in no pattern share
+   // input class 0; every other byte gets a class (i.e. a column in the
+   // transition table) of its own.
+   //
+   UINT16 byteClass[256];
+   UINT classCount;
+   UINT stateCount;
+
+   UINT16* transitions;
+   UINT16* depth;  // length of the pattern prefix a state stands for
+   UINT8* match;   // 1-based rule index of the match ending at a state
+} PATTERN_MATCHER;
+
+NTSTATUS
+PatternMatcherAddRule(
+   _Inout_ PATTERN_MATCHER* matcher,
+   _In_reads_bytes_(findLength) const void* find,
+   UINT findLength,
+   _In_reads_bytes_(replaceLength) const void* replace,
+   UINT replaceLength
+   );
+
+NTSTATUS
+PatternMatcherBuild(
+   _Inout_ PATTERN_MATCHER* matcher
+   );
+
+void
+PatternMatcherCleanup(
+   _Inout_ PATTERN_MATCHER* matcher
+   );
+
+BOOLEAN
+PatternMatcherScan(
+   _In_ const PATTERN_MATCHER* matcher,
+   _Inout_ PATTERN_MATCH_STATE* state,
+   _In_reads_bytes_(length) const void* data,
+   size_t length,
+   _Out_ size_t* bytesScanned,
+   _Outptr_result_maybenull_ const PATTERN_MATCH_RULE** rule
+   );
+
+__inline
+size_t
+PatternMatcherPendingLength(
+   _In_ const PATTERN_MATCHER* matcher,
+   PATTERN_MATCH_STATE state
+   )
+/* ++
+
+   Returns the number of trailing bytes scanned so far that could still be 
+   the beginning of a match; this data must not be released to the stream
+   until more data is seen.
+
+-- */
+{
+   return matcher->depth[state];
+}
+
+#endif // _PATTERN_MATCH_H
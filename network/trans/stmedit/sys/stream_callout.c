@@ -24,10 +24,17 @@ Abstract:
       
       o  StringToFind (REG_SZ, default = "rainy")
       o  StringToReplace (REG_SZ, default = "sunny")
+      o  StringsToFind (REG_MULTI_SZ, optional)
+      o  StringsToReplace (REG_MULTI_SZ, optional)
       o  InspectionPort (REG_DWORD, default = 5001)
       o  InspectOutbound (REG_DWORD, default = 0)
       o  EditInline (REG_DWORD, default = 0)
 
+   StringsToFind and StringsToReplace, when present, take precedence over the
+   single string pair and specify up to 64 rules (the n-th string to find is
+   replaced by the n-th replacement string). All rules are matched in a 
+   single pass over the stream.
+
    The sample is IP version agnostic. It performs inspection on both IPv4 and
    IPv6 data streams.
 
@@ -54,6 +61,7 @@ Environment:
 
 #include "inline_edit.h"
 #include "oob_edit.h"
+#include "pattern_match.h"
 #include "stream_callout.h"
 
 #define INITGUID
@@ -95,7 +103,7 @@ DEFINE_GUID(
 // Callout driver global variables
 //
 
-MDL* gStringToReplaceMdl;
+PATTERN_MATCHER gPatternMatcher;
 
 STREAM_EDITOR gStreamEditor;
 
@@ -369,7 +377,7 @@ StreamEditEvtDriverUnload(
    NdisFreeNetBufferListPool(gNetBufferListPool);
    NdisFreeGenericObject(gNdisGenericObj);
 
-   IoFreeMdl(gStringToReplaceMdl);
+   PatternMatcherCleanup(&gPatternMatcher);
 }
 
 NTSTATUS
@@ -479,6 +487,173 @@ Exit:
    return status;
 }
 
+NTSTATUS
+StreamEditLoadRuleStrings(
+   const WDFKEY key,
+   const UNICODE_STRING* valueName,
+   _Inout_ WDFCOLLECTION* strings
+   )
+{
+   NTSTATUS status;
+
+   status = WdfCollectionCreate(WDF_NO_OBJECT_ATTRIBUTES, strings);
+
+   if (!NT_SUCCESS(status))
+   {
+      goto Exit;
+   }
+
+   status = WdfRegistryQueryMultiString(
+               key,
+               valueName,
+               WDF_NO_OBJECT_ATTRIBUTES,
+               *strings
+               );
+
+Exit:
+   return status;
+}
+
+NTSTATUS
+StreamEditLoadRules(
+   const WDFKEY key
+   )
+/* ++
+
+   This function adds the configured find/replace rules to the pattern 
+   matcher and builds the matcher. The StringsToFind/StringsToReplace pair 
+   is used if present; otherwise the StringToFind/StringToReplace values (or 
+   their defaults) form the only rule.
+
+-- */
+{
+   NTSTATUS status;
+   DECLARE_CONST_UNICODE_STRING(stringsToFindKey, L"StringsToFind");
+   DECLARE_CONST_UNICODE_STRING(stringsToReplaceKey, L"StringsToReplace");
+
+   WDFCOLLECTION findStrings = NULL;
+   WDFCOLLECTION replaceStrings = NULL;
+
+   CHAR find[PATTERN_MATCH_MAX_FIND_LENGTH + 1];
+   CHAR replace[128];
+   ULONG findSize;
+   ULONG replaceSize;
+   ULONG count;
+   ULONG i;
+
+   status = StreamEditLoadRuleStrings(
+               key,
+               &stringsToFindKey,
+               &findStrings
+               );
+
+   if (!NT_SUCCESS(status))
+   {
+      status = PatternMatcherAddRule(
+                  &gPatternMatcher,
+                  configStringToFind,
+                  (UINT) strlen(configStringToFind),
+                  configStringToReplace,
+                  (UINT) strlen(configStringToReplace)
+                  );
+
+      if (!NT_SUCCESS(status))
+      {
+         goto Exit;
+      }
+   }
+   else
+   {
+      status = StreamEditLoadRuleStrings(
+                  key,
+                  &stringsToReplaceKey,
+                  &replaceStrings
+                  );
+
+      if (!NT_SUCCESS(status))
+      {
+         goto Exit;
+      }
+
+      count = WdfCollectionGetCount(findStrings);
+
+      if ((count == 0) || (count != WdfCollectionGetCount(replaceStrings)))
+      {
+         status = STATUS_INVALID_PARAMETER;
+         goto Exit;
+      }
+
+      for (i = 0; i < count; ++i)
+      {
+         UNICODE_STRING findValue;
+         UNICODE_STRING replaceValue;
+
+         WdfStringGetUnicodeString(
+            (WDFSTRING) WdfCollectionGetItem(findStrings, i),
+            &findValue
+            );
+         WdfStringGetUnicodeString(
+            (WDFSTRING) WdfCollectionGetItem(replaceStrings, i),
+            &replaceValue
+            );
+
+         status = RtlUnicodeToMultiByteN(
+                     find,
+                     sizeof(find) - 1,
+                     &findSize,
+                     findValue.Buffer,
+                     findValue.Length
+                     );
+
+         if (!NT_SUCCESS(status))
+         {
+            goto Exit;
+         }
+
+         status = RtlUnicodeToMultiByteN(
+                     replace,
+                     sizeof(replace) - 1,
+                     &replaceSize,
+                     replaceValue.Buffer,
+                     replaceValue.Length
+                     );
+
+         if (!NT_SUCCESS(status))
+         {
+            goto Exit;
+         }
+
+         status = PatternMatcherAddRule(
+                     &gPatternMatcher,
+                     find,
+                     findSize,
+                     replace,
+                     replaceSize
+                     );
+
+         if (!NT_SUCCESS(status))
+         {
+            goto Exit;
+         }
+      }
+   }
+
+   status = PatternMatcherBuild(&gPatternMatcher);
+
+Exit:
+
+   if (findStrings != NULL)
+   {
+      WdfObjectDelete(findStrings);
+   }
+   if (replaceStrings != NULL)
+   {
+      WdfObjectDelete(replaceStrings);
+   }
+
+   return status;
+}
+
 NTSTATUS
 StreamEditInitDriverObjects(
    _Inout_ DRIVER_OBJECT* driverObject,
@@ -580,21 +755,13 @@ DriverEntry(
       goto Exit;
    }
 
-   gStringToReplaceMdl = IoAllocateMdl(
-                           configStringToReplace,
-                           (ULONG) strlen(configStringToReplace),
-                           FALSE,
-                           FALSE,
-                           NULL
-                           );
-   if (gStringToReplaceMdl == NULL)
+   status = StreamEditLoadRules(configKey);
+
+   if (!NT_SUCCESS(status))
    {
-      status = STATUS_NO_MEMORY;
       goto Exit;
    }
 
-   MmBuildMdlForNonPagedPool(gStringToReplaceMdl);
-
    gNdisGenericObj = NdisAllocateGenericObject(
                         driverObject, 
                         STREAM_EDITOR_NDIS_OBJ_TAG, 
@@ -685,10 +852,7 @@ Exit:
       {
          NdisFreeGenericObject(gNdisGenericObj);
       }
-      if (gStringToReplaceMdl != NULL)
-      {
-         IoFreeMdl(gStringToReplaceMdl);
-      }
+      PatternMatcherCleanup(&gPatternMatcher);
    }
 
    return status;
@@ -14,7 +14,7 @@ Abstract:
 #ifndef _STREAM_CALLOUT_H
 #define _STREAM_CALLOUT_H
 
-extern MDL* gStringToReplaceMdl;
+extern PATTERN_MATCHER gPatternMatcher;
 extern HANDLE gInjectionHandle;
 extern NDIS_HANDLE gNetBufferListPool;
 extern STREAM_EDITOR gStreamEditor;
@@ -66,6 +66,16 @@ typedef struct STREAM_EDITOR_
    size_t dataOffset;
    size_t dataLength;
 
+   //
+   // Matcher state at the end of the data scanned so far and the number of
+   // bytes at the front of the (inspection) data it already accounts for.
+   // The inline editor also remembers the rule that matched at the front of
+   // the data to be indicated next.
+   //
+   PATTERN_MATCH_STATE matchState;
+   size_t scannedLength;
+   const PATTERN_MATCH_RULE* matchRule;
+
 }STREAM_EDITOR;
 
 #pragma warning(pop)
@@ -76,4 +86,13 @@ StreamCopyDataForInspection(
    const FWPS_STREAM_DATA* streamData
    );
 
+NTSTATUS
+StreamScanDataInPlace(
+   const FWPS_STREAM_DATA* streamData,
+   size_t scanOffset,
+   _Inout_ PATTERN_MATCH_STATE* matchState,
+   _Out_ size_t* bytesScanned,
+   _Outptr_result_maybenull_ const PATTERN_MATCH_RULE** rule
+   );
+
 #endif // _STREAM_CALLOUT_H
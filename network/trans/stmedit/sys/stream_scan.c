@@ -0,0 +1,194 @@
+/*++
+
+Copyright (c) Microsoft Corporation. All rights reserved
+
+Abstract:
+
+    Stream Edit Callout Driver Sample.
+    
+    This file scans stream data in place, walking the NBL, NET_BUFFER and
+    MDL chains of the indication rather than copying the data out.
+
+    It is also built into the user mode benchmark in the bench directory,
+    together with pattern_match.c; bench\streamBench.h stands in for the
+    kernel and WFP headers there.
+
+Environment:
+
+    Kernel & user mode
+
+--*/
+
+#if defined(_KERNEL_MODE)
+
+#include <ntddk.h>
+
+#pragma warning(push)
+#pragma warning(disable:4201)       // unnamed struct/union
+
+#include <fwpsk.h>
+
+#pragma warning(pop)
+
+#include <fwpmk.h>
+
+#include "inline_edit.h"
+#include "oob_edit.h"
+#include "pattern_match.h"
+#include "stream_callout.h"
+
+#else
+
+#include "streamBench.h"
+
+#endif
+
+size_t
+StreamDataNetBufferRemaining(
+   _In_ NET_BUFFER* netBuffer,
+   _In_ MDL* mdl,
+   size_t mdlOffset
+   )
+/* ++
+
+   This function returns the number of bytes of the net buffer that follow
+   the given MDL position.
+
+-- */
+{
+   MDL* currentMdl = NET_BUFFER_CURRENT_MDL(netBuffer);
+   size_t currentOffset = NET_BUFFER_CURRENT_MDL_OFFSET(netBuffer);
+   size_t consumed = 0;
+
+   while (currentMdl != mdl)
+   {
+      NT_ASSERT(currentMdl != NULL);
+
+      consumed += MmGetMdlByteCount(currentMdl) - currentOffset;
+      currentOffset = 0;
+      currentMdl = currentMdl->Next;
+   }
+
+   consumed += mdlOffset - currentOffset;
+
+   NT_ASSERT(consumed <= NET_BUFFER_DATA_LENGTH(netBuffer));
+
+   return NET_BUFFER_DATA_LENGTH(netBuffer) - consumed;
+}
+
+NTSTATUS
+StreamScanDataInPlace(
+   const FWPS_STREAM_DATA* streamData,
+   size_t scanOffset,
+   _Inout_ PATTERN_MATCH_STATE* matchState,
+   _Out_ size_t* bytesScanned,
+   _Outptr_result_maybenull_ const PATTERN_MATCH_RULE** rule
+   )
+/* ++
+
+   This function runs the pattern matcher over stream data described by the
+   FWPS_STREAM_DATA structure by walking its NBL/NET_BUFFER/MDL chains, 
+   without copying the data. The first scanOffset bytes (already accounted 
+   for by *matchState) are skipped.
+
+   On return *bytesScanned is the offset from the start of the stream data 
+   right past the match if *rule is set, or streamData->dataLength otherwise.
+
+-- */
+{
+   NTSTATUS status = STATUS_SUCCESS;
+
+   NET_BUFFER_LIST* netBufferList = streamData->dataOffset.netBufferList;
+   NET_BUFFER* netBuffer = streamData->dataOffset.netBuffer;
+   MDL* mdl = streamData->dataOffset.mdl;
+   size_t mdlOffset = streamData->dataOffset.mdlOffset;
+   size_t netBufferRemaining;
+   size_t position = 0;
+
+   *rule = NULL;
+
+   if (streamData->dataLength == 0)
+   {
+      goto Exit;
+   }
+
+   netBufferRemaining = StreamDataNetBufferRemaining(netBuffer, mdl, mdlOffset);
+
+   while (position < streamData->dataLength)
+   {
+      size_t length;
+
+      if (netBufferRemaining == 0)
+      {
+         netBuffer = NET_BUFFER_NEXT_NB(netBuffer);
+
+         if (netBuffer == NULL)
+         {
+            netBufferList = NET_BUFFER_LIST_NEXT_NBL(netBufferList);
+            NT_ASSERT(netBufferList != NULL);
+            _Analysis_assume_(netBufferList != NULL);
+
+            netBuffer = NET_BUFFER_LIST_FIRST_NB(netBufferList);
+         }
+
+         mdl = NET_BUFFER_CURRENT_MDL(netBuffer);
+         mdlOffset = NET_BUFFER_CURRENT_MDL_OFFSET(netBuffer);
+         netBufferRemaining = NET_BUFFER_DATA_LENGTH(netBuffer);
+
+         continue;
+      }
+
+      NT_ASSERT(mdl != NULL);
+      _Analysis_assume_(mdl != NULL);
+
+      if (mdlOffset >= MmGetMdlByteCount(mdl))
+      {
+         mdl = mdl->Next;
+         mdlOffset = 0;
+
+         continue;
+      }
+
+      length = MmGetMdlByteCount(mdl) - mdlOffset;
+      length = min(length, netBufferRemaining);
+      length = min(length, streamData->dataLength - position);
+
+      if (position + length > scanOffset)
+      {
+         size_t skip = (position < scanOffset) ? (scanOffset - position) : 0;
+         size_t scanned;
+         BYTE* va;
+
+         va = MmGetSystemAddressForMdlSafe(mdl, NormalPagePriority);
+
+         if (va == NULL)
+         {
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            goto Exit;
+         }
+
+         if (PatternMatcherScan(
+               &gPatternMatcher,
+               matchState,
+               va + mdlOffset + skip,
+               length - skip,
+               &scanned,
+               rule
+               ))
+         {
+            position += skip + scanned;
+            goto Exit;
+         }
+      }
+
+      position += length;
+      mdlOffset += length;
+      netBufferRemaining -= length;
+   }
+
+Exit:
+
+   *bytesScanned = position;
+
+   return status;
+}
@@ -12,10 +12,11 @@ Abstract:
     Winsock Kernel (WSK) programming interface. The application accepts
     incoming connection requests and, on each connection, echoes all received
     data back to the peer until the connection is closed by the peer.
-    The application is designed to use a single worker thread to perform all of
-    its processing. For better performance on MP machines, the sample may be 
-    enhanced to use more worker threads. Operations on a given connection 
-    should always be processed by the same worker thread. This provides a
+    The application uses one work queue per processor, each drained by its own
+    worker thread that is affinitized to that processor. Each connection is
+    assigned to one of the work queues by hashing its remote address and port,
+    and operations on a given connection are always processed by the same
+    worker thread. This provides a
     simple form of synchronization ensuring proper socket closure in a setting
     where multiple operations may be outstanding and completed asynchronously
     on a given connection. For the sake of simplicty, this sample does not
@@ -24,6 +25,12 @@ Abstract:
     time a connection stays around. A full-fledged server application should be
     designed with these points in mind from a security viewpoint. 
 
+    If the ZeroCopyEcho registry value under the driver's service key is set
+    to a non-zero DWORD, the application runs in zero-copy echo mode instead.
+    In this mode, received data is taken from the WskReceiveEvent callback by
+    retaining the WSK_DATA_INDICATION buffers of the stack, which are sent
+    back to the peer as is and then returned with WskRelease.
+
 Author:
 
 Environment:
@@ -86,6 +93,9 @@ typedef struct _WSKSAMPLE_WORK_QUEUE {
 
     // Worker thread pointer
     PETHREAD Thread;
+
+    // Index of the processor the worker thread is affinitized to
+    ULONG ProcessorIndex;
     
 } WSKSAMPLE_WORK_QUEUE, *PWSKSAMPLE_WORK_QUEUE;
 
@@ -109,12 +119,29 @@ typedef struct _WSKSAMPLE_SOCKET_OP_CONTEXT {
     PMDL   DataMdl;
     SIZE_T BufferLength; // size of the buffer
     SIZE_T DataLength;   // length of actual data stored in the buffer
+
+    // Data indications retained from WskReceiveEvent in zero-copy echo mode,
+    // and the one currently being sent back. The whole list is returned
+    // with WskRelease once all of it has been sent.
+    PWSK_DATA_INDICATION DataIndication;
+    PWSK_DATA_INDICATION CurrentIndication;
     
 } WSKSAMPLE_SOCKET_OP_CONTEXT;
 
 // Maximum number of operations that can be outstanding on a socket at any time 
 #define WSKSAMPLE_OP_COUNT 2
 
+// In zero-copy echo mode, the first operation context of a connected socket
+// echoes data back to the peer, and the second one is used for the
+// disconnect or close operation requested by the connection callbacks.
+#define WSKSAMPLE_ECHO_OP 0
+#define WSKSAMPLE_CONTROL_OP 1
+
+// States of the echo operation context in zero-copy echo mode
+#define WSKSAMPLE_ECHO_IDLE 0 // ready to take a data indication
+#define WSKSAMPLE_ECHO_BUSY 1 // sending data back to the peer
+#define WSKSAMPLE_ECHO_BACKLOGGED 2 // busy, and an indication was declined
+
 // Structure that represents the context for a WSK socket.
 typedef struct _WSKSAMPLE_SOCKET_CONTEXT {
 
@@ -134,6 +161,15 @@ typedef struct _WSKSAMPLE_SOCKET_CONTEXT {
     // Stop accepting incoming connections. Valid for listening sockets only.
     BOOLEAN StopListening;
 
+    // State of the echo operation context (WSKSAMPLE_ECHO_XXX) in zero-copy
+    // echo mode. Updated with interlocked operations since it is shared by the
+    // receive event callback and the send completions.
+    LONG EchoState;
+
+    // Set once the control operation context has been enqueued by one of the
+    // connection callbacks in zero-copy echo mode.
+    LONG ControlOpQueued;
+
     // Embedded array of contexts for outstanding operations on the socket.
     // Note that operation contexts could also be allocated separately. This
     // sample preallocates a fixed number of operation contexts along with
@@ -155,6 +191,24 @@ WskSampleAcceptEvent(
     _Outptr_result_maybenull_ CONST WSK_CLIENT_CONNECTION_DISPATCH **AcceptSocketDispatch
     );
 
+// Forward declarations for the callbacks in WSK_CLIENT_CONNECTION_DISPATCH
+NTSTATUS
+WSKAPI
+WskSampleReceiveEvent(
+    _In_opt_ PVOID SocketContext,
+    _In_ ULONG Flags,
+    _In_opt_ PWSK_DATA_INDICATION DataIndication,
+    _In_ SIZE_T BytesIndicated,
+    _Inout_ SIZE_T *BytesAccepted
+    );
+
+NTSTATUS
+WSKAPI
+WskSampleDisconnectEvent(
+    _In_opt_ PVOID SocketContext,
+    _In_ ULONG Flags
+    );
+
 // Client-level callback table
 const WSK_CLIENT_DISPATCH WskSampleClientDispatch = {
     MAKE_WSK_VERSION(1, 0), // This sample uses WSK version 1.0
@@ -172,11 +226,23 @@ const WSK_CLIENT_LISTEN_DISPATCH WskSampleClientListenDispatch = {
     NULL  // WskAbortEvent is required only if conditional-accept is used.
 };
 
+// Socket-level callback table for accepted sockets in zero-copy echo mode
+const WSK_CLIENT_CONNECTION_DISPATCH WskSampleClientConnectionDispatch = {
+    WskSampleReceiveEvent,
+    WskSampleDisconnectEvent,
+    NULL  // WskSendBacklogEvent is not used.
+};
+
+// Echo received data by retaining the data indications of the stack
+BOOLEAN WskSampleZeroCopyEcho;
+
 // Global reference to the socket context for the listening socket
 PWSKSAMPLE_SOCKET_CONTEXT WskSampleListeningSocketContext;
 
-// Global work queue used for enqueueing all socket operations
-WSKSAMPLE_WORK_QUEUE WskSampleWorkQueue;
+// Per-processor work queues used for enqueueing socket operations. The
+// listening socket always uses the first work queue.
+PWSKSAMPLE_WORK_QUEUE WskSampleWorkQueues;
+ULONG WskSampleWorkQueueCount;
 
 // IPv6 wildcard address and port number 40007 to listen on
 SOCKADDR_IN6 IPv6ListeningAddress = {
@@ -218,6 +284,21 @@ WskSampleFreeSocketContext(
     _In_ PWSKSAMPLE_SOCKET_CONTEXT SocketContext
     );
 
+VOID
+WskSampleReleaseIndication(
+    _In_ PWSKSAMPLE_SOCKET_OP_CONTEXT SocketOpContext
+    );
+
+VOID
+WskSampleEchoDone(
+    _In_ PWSKSAMPLE_SOCKET_OP_CONTEXT SocketOpContext
+    );
+
+VOID
+WskSampleReadConfiguration(
+    _In_ PUNICODE_STRING RegistryPath
+    );
+
 _At_(SocketOpContext, __drv_aliasesMem)
 VOID
 WskSampleEnqueueOp(
@@ -273,7 +354,8 @@ WskSampleOpFree(
 
 NTSTATUS
 WskSampleStartWorkQueue(
-    _Out_ PWSKSAMPLE_WORK_QUEUE WorkQueue
+    _Out_ PWSKSAMPLE_WORK_QUEUE WorkQueue,
+    _In_ ULONG ProcessorIndex
     );
 
 VOID
@@ -281,6 +363,21 @@ WskSampleStopWorkQueue(
     _In_ PWSKSAMPLE_WORK_QUEUE WorkQueue
     );
 
+NTSTATUS
+WskSampleStartWorkQueues(
+    VOID
+    );
+
+VOID
+WskSampleStopWorkQueues(
+    VOID
+    );
+
+PWSKSAMPLE_WORK_QUEUE
+WskSampleSelectWorkQueue(
+    _In_ PSOCKADDR RemoteAddress
+    );
+
 VOID
 WskSampleUnload(
     _In_ PDRIVER_OBJECT DriverObject
@@ -289,9 +386,12 @@ WskSampleUnload(
 #ifdef ALLOC_PRAGMA
 
 #pragma alloc_text(INIT, DriverEntry)
+#pragma alloc_text(INIT, WskSampleReadConfiguration)
 #pragma alloc_text(INIT, WskSampleStartWorkQueue)
+#pragma alloc_text(INIT, WskSampleStartWorkQueues)
 #pragma alloc_text(PAGE, WskSampleUnload)
 #pragma alloc_text(PAGE, WskSampleStopWorkQueue)
+#pragma alloc_text(PAGE, WskSampleStopWorkQueues)
 #pragma alloc_text(PAGE, WskSampleWorkerThread)
 #pragma alloc_text(PAGE, WskSampleOpStartListen)
 #pragma alloc_text(PAGE, WskSampleOpStopListen)
@@ -317,13 +417,31 @@ DriverEntry(
     UNREFERENCED_PARAMETER(RegistryPath);
 
     PAGED_CODE();
+
+    WskSampleReadConfiguration(RegistryPath);
+
+    // Allocate the per-processor work queues. The worker threads are not
+    // started until after the registration with WSK.
+    WskSampleWorkQueueCount = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    WskSampleWorkQueues = ExAllocatePoolWithTag(
+        NonPagedPool, 
+        WskSampleWorkQueueCount * sizeof(WSKSAMPLE_WORK_QUEUE),
+        WSKSAMPLE_GENERIC_POOL_TAG);
+
+    if(WskSampleWorkQueues == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(WskSampleWorkQueues, 
+        WskSampleWorkQueueCount * sizeof(WSKSAMPLE_WORK_QUEUE));
     
     // Allocate a socket context that will be used for queueing an operation
     // to setup a listening socket that will accept incoming connections
     WskSampleListeningSocketContext = WskSampleAllocateSocketContext(
-                                            &WskSampleWorkQueue, 0);
+                                            &WskSampleWorkQueues[0], 0);
 
     if(WskSampleListeningSocketContext == NULL) {
+        ExFreePool(WskSampleWorkQueues);
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
@@ -334,15 +452,17 @@ DriverEntry(
 
     if(!NT_SUCCESS(status)) {
         WskSampleFreeSocketContext(WskSampleListeningSocketContext);
+        ExFreePool(WskSampleWorkQueues);
         return status;
     }
 
-    // Initialize and start the global work queue
-    status = WskSampleStartWorkQueue(&WskSampleWorkQueue);
+    // Initialize and start the per-processor work queues
+    status = WskSampleStartWorkQueues();
 
     if(!NT_SUCCESS(status)) {
         WskDeregister(&WskSampleRegistration);
         WskSampleFreeSocketContext(WskSampleListeningSocketContext);
+        ExFreePool(WskSampleWorkQueues);
         return status;
     }
 
@@ -362,6 +482,33 @@ DriverEntry(
     return STATUS_SUCCESS;
 }
 
+// Read the optional configuration values from the driver's service key
+VOID
+WskSampleReadConfiguration(
+    _In_ PUNICODE_STRING RegistryPath
+    )
+{
+    RTL_QUERY_REGISTRY_TABLE queryTable[2];
+    ULONG zeroCopyEcho = 0;
+
+    PAGED_CODE();
+
+    // The ZeroCopyEcho value is optional. If it's missing or of the wrong
+    // type, the default copying echo mode is used.
+    RtlZeroMemory(queryTable, sizeof(queryTable));
+    queryTable[0].Flags = RTL_QUERY_REGISTRY_DIRECT | 
+                          RTL_QUERY_REGISTRY_TYPECHECK;
+    queryTable[0].Name = L"ZeroCopyEcho";
+    queryTable[0].EntryContext = &zeroCopyEcho;
+    queryTable[0].DefaultType = 
+        (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_NONE;
+
+    (VOID)RtlQueryRegistryValues(RTL_REGISTRY_ABSOLUTE, RegistryPath->Buffer,
+                                 queryTable, NULL, NULL);
+
+    WskSampleZeroCopyEcho = (zeroCopyEcho != 0);
+}
+
 // Driver unload routine
 VOID
 WskSampleUnload(
@@ -405,9 +552,10 @@ WskSampleUnload(
     // WskDeregister returns only if all the sockets are closed. Thus, at this
     // point, it's guaranteed that all socket are closed, which also means that
     // there can not be any further outstanding operations on any socket. So,
-    // the worker thread can now safely stop processing the work queue if there
-    // are no queued items. Signal the worker thread to stop and wait for it. 
-    WskSampleStopWorkQueue(&WskSampleWorkQueue);
+    // the worker threads can now safely stop processing the work queues if
+    // there are no queued items. Signal the worker threads to stop and wait
+    // for them. 
+    WskSampleStopWorkQueues();
     
     DoTraceMessage(TRCINFO, "UNLOAD END");
 
@@ -417,7 +565,8 @@ WskSampleUnload(
 // Initialize a given work queue and start the worker thread for it
 NTSTATUS
 WskSampleStartWorkQueue(
-    _Out_ PWSKSAMPLE_WORK_QUEUE WorkQueue
+    _Out_ PWSKSAMPLE_WORK_QUEUE WorkQueue,
+    _In_ ULONG ProcessorIndex
     )
 {
     NTSTATUS status;
@@ -428,6 +577,7 @@ WskSampleStartWorkQueue(
     InitializeSListHead(&WorkQueue->Head);
     KeInitializeEvent(&WorkQueue->Event, SynchronizationEvent, FALSE);
     WorkQueue->Stop = FALSE;
+    WorkQueue->ProcessorIndex = ProcessorIndex;
 
     status = PsCreateSystemThread(
                 &threadHandle, THREAD_ALL_ACCESS, NULL, NULL, NULL,
@@ -440,13 +590,16 @@ WskSampleStartWorkQueue(
     status = ObReferenceObjectByHandle(
                 threadHandle, THREAD_ALL_ACCESS, NULL, KernelMode,
                 &WorkQueue->Thread, NULL);
-    
-    ZwClose(threadHandle);
 
     if(!NT_SUCCESS(status)) {
+        // Wait for the worker thread to exit since the caller frees the
+        // work queue on failure.
         WorkQueue->Stop = TRUE;
         KeSetEvent(&WorkQueue->Event, 0, FALSE);
+        ZwWaitForSingleObject(threadHandle, FALSE, NULL);
     }
+    
+    ZwClose(threadHandle);
 
     return status;
 }
@@ -467,6 +620,88 @@ WskSampleStopWorkQueue(
     ObDereferenceObject(WorkQueue->Thread);
 }
 
+// Initialize and start a work queue for each active processor
+NTSTATUS
+WskSampleStartWorkQueues(
+    VOID
+    )
+{
+    NTSTATUS status;
+    ULONG i;
+
+    PAGED_CODE();
+
+    for(i = 0; i < WskSampleWorkQueueCount; i++) {
+
+        status = WskSampleStartWorkQueue(&WskSampleWorkQueues[i], i);
+
+        if(!NT_SUCCESS(status)) {
+
+            DoTraceMessage(TRCERROR, 
+                "StartWorkQueues: WQ %lu FAIL 0x%lx", i, status);
+
+            // The worker thread of the failed work queue, if one was created,
+            // has already been told to stop. Stop the ones started before it.
+            while(i > 0) {
+                i--;
+                WskSampleStopWorkQueue(&WskSampleWorkQueues[i]);
+            }
+
+            return status;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+// Stop all the work queues, and free them once their worker threads exit
+VOID
+WskSampleStopWorkQueues(
+    VOID
+    )
+{
+    ULONG i;
+
+    PAGED_CODE();
+
+    for(i = 0; i < WskSampleWorkQueueCount; i++) {
+        WskSampleStopWorkQueue(&WskSampleWorkQueues[i]);
+    }
+
+    ExFreePool(WskSampleWorkQueues);
+    WskSampleWorkQueues = NULL;
+}
+
+// Select the work queue for a new connection by hashing its remote address
+// and port, so that connections are spread across the worker threads
+PWSKSAMPLE_WORK_QUEUE
+WskSampleSelectWorkQueue(
+    _In_ PSOCKADDR RemoteAddress
+    )
+{
+    PUCHAR bytes;
+    ULONG length;
+    ULONG hash = 2166136261; // FNV-1a offset basis
+    ULONG i;
+
+    if(RemoteAddress->sa_family == AF_INET6) {
+        bytes = (PUCHAR)&((PSOCKADDR_IN6)RemoteAddress)->sin6_addr;
+        length = sizeof(IN6_ADDR);
+        hash = (hash ^ ((PSOCKADDR_IN6)RemoteAddress)->sin6_port) * 16777619;
+    }
+    else {
+        bytes = (PUCHAR)&((PSOCKADDR_IN)RemoteAddress)->sin_addr;
+        length = sizeof(IN_ADDR);
+        hash = (hash ^ ((PSOCKADDR_IN)RemoteAddress)->sin_port) * 16777619;
+    }
+
+    for(i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 16777619;
+    }
+
+    return &WskSampleWorkQueues[hash % WskSampleWorkQueueCount];
+}
+
 // Allocate and setup a socket context
 _Must_inspect_result_
 __drv_allocatesMem(Mem)
@@ -480,11 +715,8 @@ WskSampleAllocateSocketContext(
     PWSKSAMPLE_SOCKET_CONTEXT socketContext;
     
     // Allocate and setup a socket context with optional data buffers, and
-    // attach the socket to the given work queue. Even though this sample uses
-    // only a single global work queue, the sample is designed to be easily
-    // adaptable to using multiple work queues. If the sample is changed to
-    // use multiple work queues (say a work queue per processor), a given
-    // socket will/must always use the same work queue.
+    // attach the socket to the given work queue. A given socket will/must
+    // always use the same work queue.
 
     socketContext = ExAllocatePoolWithTag(
         NonPagedPool, sizeof(*socketContext), WSKSAMPLE_SOCKET_POOL_TAG);
@@ -610,13 +842,28 @@ WskSampleWorkerThread (
     _In_ PVOID Context
     )
 {
+    NTSTATUS status;
     PWSKSAMPLE_WORK_QUEUE workQueue;
     PSLIST_ENTRY listEntryRev, listEntry, next;
+    PROCESSOR_NUMBER processorNumber;
+    GROUP_AFFINITY affinity;
     
     PAGED_CODE();
 
     workQueue = (PWSKSAMPLE_WORK_QUEUE)Context;
 
+    // Run on the processor this work queue belongs to. If the processor
+    // number can not be resolved, the thread simply runs unaffinitized.
+    status = KeGetProcessorNumberFromIndex(
+                workQueue->ProcessorIndex, &processorNumber);
+
+    if(NT_SUCCESS(status)) {
+        RtlZeroMemory(&affinity, sizeof(affinity));
+        affinity.Group = processorNumber.Group;
+        affinity.Mask = AFFINITY_MASK(processorNumber.Number);
+        KeSetSystemGroupAffinityThread(&affinity, NULL);
+    }
+
     for(;;) {
         
         // Flush all the queued operations into a local list
@@ -758,8 +1005,13 @@ WskSampleSetupListeningSocket(
     else {
         // First, configure the WSK client such that WskAcceptEvent callback
         // will be automatically enabled on the listening socket upon creation.
+        // In zero-copy echo mode, the receive and disconnect callbacks are
+        // enabled the same way on the sockets accepted over it.
         callbackControl.NpiId = (PNPIID)&NPI_WSK_INTERFACE_ID;
         callbackControl.EventMask = WSK_EVENT_ACCEPT;
+        if(WskSampleZeroCopyEcho) {
+            callbackControl.EventMask |= WSK_EVENT_RECEIVE | WSK_EVENT_DISCONNECT;
+        }
         status = WskProviderNpi->Dispatch->WskControlClient(
                             WskProviderNpi->Client,
                             WSK_SET_STATIC_EVENT_CALLBACKS,
@@ -954,7 +1206,6 @@ WskSampleAcceptEvent(
 
     UNREFERENCED_PARAMETER(Flags);
     UNREFERENCED_PARAMETER(LocalAddress);
-    UNREFERENCED_PARAMETER(RemoteAddress);
     
     listeningSocketContext = (PWSKSAMPLE_SOCKET_CONTEXT)SocketContext;
 
@@ -976,9 +1227,11 @@ WskSampleAcceptEvent(
         return STATUS_REQUEST_NOT_ACCEPTED;
     }
 
-    // Allocate socket context for the newly accepted socket.
+    // Allocate socket context for the newly accepted socket, and attach it
+    // to the work queue selected by the hash of the remote endpoint.
     socketContext = WskSampleAllocateSocketContext(
-                        &WskSampleWorkQueue, WSKSAMPLE_DATA_BUFFER_LENGTH);
+                        WskSampleSelectWorkQueue(RemoteAddress),
+                        WSKSAMPLE_DATA_BUFFER_LENGTH);
     
     if(socketContext == NULL) {
         return STATUS_REQUEST_NOT_ACCEPTED;
@@ -987,6 +1240,16 @@ WskSampleAcceptEvent(
     socketContext->Socket = AcceptSocket;
 
     DoTraceMessage(TRCINFO, "AcceptEvent: %p", socketContext);
+
+    if(WskSampleZeroCopyEcho) {
+        // Data will be indicated through WskSampleReceiveEvent, so no
+        // receive operations are enqueued. The echo operation context is
+        // idle until the first data indication.
+        socketContext->EchoState = WSKSAMPLE_ECHO_IDLE;
+        *AcceptSocketContext = socketContext;
+        *AcceptSocketDispatch = &WskSampleClientConnectionDispatch;
+        return STATUS_SUCCESS;
+    }
     
     // Enqueue receive operations on the accepted socket. Whenever a receive
     // operation is completed successfully, the received data will be echoed
@@ -1115,9 +1378,11 @@ WskSampleOpSend(
 
     if(socketContext->Closing || socketContext->Disconnecting) {
         // Do not call WskSend if socket is being disconnected
-        // or closed. The operation context will not be used any more.
+        // or closed. The operation context will not be used any more,
+        // so return any data indications it still holds.
         DoTraceMessage(TRCINFO, "OpSend: %p %p SKIP", 
             socketContext, SocketOpContext);
+        WskSampleReleaseIndication(SocketOpContext);
     }
     else {
         WSK_BUF wskbuf;
@@ -1125,9 +1390,16 @@ WskSampleOpSend(
 
         dispatch = socketContext->Socket->Dispatch;
 
-        wskbuf.Offset = 0;
-        wskbuf.Length = SocketOpContext->DataLength;
-        wskbuf.Mdl = SocketOpContext->DataMdl;
+        if(SocketOpContext->CurrentIndication != NULL) {
+            // Send the buffer of the retained data indication back as is.
+            // Its MDL chain is owned by the WSK subsystem until released.
+            wskbuf = SocketOpContext->CurrentIndication->Buffer;
+        }
+        else {
+            wskbuf.Offset = 0;
+            wskbuf.Length = SocketOpContext->DataLength;
+            wskbuf.Mdl = SocketOpContext->DataMdl;
+        }
 
         IoReuseIrp(SocketOpContext->Irp, STATUS_UNSUCCESSFUL);
         IoSetCompletionRoutine(SocketOpContext->Irp,
@@ -1171,9 +1443,22 @@ WskSampleSendIrpCompletionRoutine(
         socketOpContext, Irp->IoStatus.Status, Irp->IoStatus.Information);
 
     if(!NT_SUCCESS(Irp->IoStatus.Status)) {
-        // Send failed. Enqueue an operation to close the socket.
+        // Send failed. Enqueue an operation to close the socket. Any
+        // retained data indications are released by the close operation.
         WskSampleEnqueueOp(socketOpContext, WskSampleOpClose);
     }
+    else if(socketOpContext->CurrentIndication != NULL &&
+            socketOpContext->CurrentIndication->Next != NULL) {
+        // Send the next retained data indication back.
+        socketOpContext->CurrentIndication = 
+            socketOpContext->CurrentIndication->Next;
+        WskSampleEnqueueOp(socketOpContext, WskSampleOpSend);
+    }
+    else if(WskSampleZeroCopyEcho) {
+        // All the data has been echoed back.
+        WskSampleReleaseIndication(socketOpContext);
+        WskSampleEchoDone(socketOpContext);
+    }
     else {
         // Send succeeded. Enqueue an operation to receive more data.
         WskSampleEnqueueOp(socketOpContext, WskSampleOpReceive);                    
@@ -1182,6 +1467,165 @@ WskSampleSendIrpCompletionRoutine(
     return STATUS_MORE_PROCESSING_REQUIRED;
 }
 
+// Return the data indications retained by an operation context, if any
+VOID
+WskSampleReleaseIndication(
+    _In_ PWSKSAMPLE_SOCKET_OP_CONTEXT SocketOpContext
+    )
+{
+    PWSKSAMPLE_SOCKET_CONTEXT socketContext = SocketOpContext->SocketContext;
+    CONST WSK_PROVIDER_CONNECTION_DISPATCH *dispatch;
+
+    if(SocketOpContext->DataIndication != NULL) {
+
+        dispatch = socketContext->Socket->Dispatch;
+
+        DoTraceMessage(TRCINFO, "ReleaseIndication: %p %p %p", 
+            socketContext, SocketOpContext, SocketOpContext->DataIndication);
+
+        dispatch->WskRelease(socketContext->Socket, 
+                             SocketOpContext->DataIndication);
+
+        SocketOpContext->DataIndication = NULL;
+        SocketOpContext->CurrentIndication = NULL;
+    }
+}
+
+// Called in zero-copy echo mode when the echo operation context has sent all
+// of its data back. If a data indication was declined in the meantime, the
+// buffered data is retrieved with a receive operation into the data buffer of
+// the operation context. Otherwise, the context goes back to the idle state.
+VOID
+WskSampleEchoDone(
+    _In_ PWSKSAMPLE_SOCKET_OP_CONTEXT SocketOpContext
+    )
+{
+    PWSKSAMPLE_SOCKET_CONTEXT socketContext = SocketOpContext->SocketContext;
+
+    for(;;) {
+
+        if(InterlockedCompareExchange(&socketContext->EchoState,
+                                      WSKSAMPLE_ECHO_BUSY,
+                                      WSKSAMPLE_ECHO_BACKLOGGED) ==
+           WSKSAMPLE_ECHO_BACKLOGGED) {
+            // The echo operation context stays busy with the receive.
+            WskSampleEnqueueOp(SocketOpContext, WskSampleOpReceive);
+            break;
+        }
+
+        if(InterlockedCompareExchange(&socketContext->EchoState,
+                                      WSKSAMPLE_ECHO_IDLE,
+                                      WSKSAMPLE_ECHO_BUSY) ==
+           WSKSAMPLE_ECHO_BUSY) {
+            break;
+        }
+
+        // The receive event callback declined an indication in between.
+    }
+}
+
+// Connected socket callback which is invoked in zero-copy echo mode whenever
+// data is received
+NTSTATUS
+WSKAPI
+WskSampleReceiveEvent(
+    _In_opt_ PVOID SocketContext,
+    _In_ ULONG Flags,
+    _In_opt_ PWSK_DATA_INDICATION DataIndication,
+    _In_ SIZE_T BytesIndicated,
+    _Inout_ SIZE_T *BytesAccepted
+    )
+{
+    PWSKSAMPLE_SOCKET_CONTEXT socketContext;
+    PWSKSAMPLE_SOCKET_OP_CONTEXT socketOpContext;
+    LONG echoState;
+
+    UNREFERENCED_PARAMETER(Flags);
+    UNREFERENCED_PARAMETER(BytesAccepted);
+
+    _Analysis_assume_(SocketContext != NULL);
+
+    socketContext = (PWSKSAMPLE_SOCKET_CONTEXT)SocketContext;
+
+    DoTraceMessage(TRCINFO, "ReceiveEvent: %p %p %Iu", 
+        socketContext, DataIndication, BytesIndicated);
+
+    if(DataIndication == NULL) {
+        // The socket is no longer functional. Enqueue an operation to
+        // close it, unless one of the callbacks already did so.
+        if(InterlockedExchange(&socketContext->ControlOpQueued, TRUE) == FALSE) {
+            WskSampleEnqueueOp(
+                &socketContext->OpContext[WSKSAMPLE_CONTROL_OP],
+                WskSampleOpClose);
+        }
+        return STATUS_SUCCESS;
+    }
+
+    socketOpContext = &socketContext->OpContext[WSKSAMPLE_ECHO_OP];
+
+    for(;;) {
+
+        echoState = InterlockedCompareExchange(&socketContext->EchoState,
+                                               WSKSAMPLE_ECHO_BUSY,
+                                               WSKSAMPLE_ECHO_IDLE);
+
+        if(echoState == WSKSAMPLE_ECHO_IDLE) {
+            // Retain the data indications and enqueue an operation to send
+            // them back. Only one echo is outstanding at any time, so the
+            // data is echoed back in the order it was received.
+            socketOpContext->DataIndication = DataIndication;
+            socketOpContext->CurrentIndication = DataIndication;
+            WskSampleEnqueueOp(socketOpContext, WskSampleOpSend);
+            return STATUS_PENDING;
+        }
+
+        echoState = InterlockedCompareExchange(&socketContext->EchoState,
+                                               WSKSAMPLE_ECHO_BACKLOGGED,
+                                               WSKSAMPLE_ECHO_BUSY);
+
+        if(echoState != WSKSAMPLE_ECHO_IDLE) {
+            // The echo operation context is busy. Decline the data, which
+            // stays buffered in the socket until the echo operation context
+            // retrieves it with a receive operation.
+            DoTraceMessage(TRCINFO, "ReceiveEvent: %p BACKLOGGED", 
+                socketContext);
+            return STATUS_DATA_NOT_ACCEPTED;
+        }
+
+        // The echo operation context became idle in between.
+    }
+}
+
+// Connected socket callback which is invoked in zero-copy echo mode when the
+// peer disconnects
+NTSTATUS
+WSKAPI
+WskSampleDisconnectEvent(
+    _In_opt_ PVOID SocketContext,
+    _In_ ULONG Flags
+    )
+{
+    PWSKSAMPLE_SOCKET_CONTEXT socketContext;
+
+    _Analysis_assume_(SocketContext != NULL);
+
+    socketContext = (PWSKSAMPLE_SOCKET_CONTEXT)SocketContext;
+
+    DoTraceMessage(TRCINFO, "DisconnectEvent: %p 0x%lx", socketContext, Flags);
+
+    // Enqueue an operation to disconnect our half of the connection if the
+    // peer has gracefully disconnected its half, or to close the socket if
+    // the connection was aborted.
+    if(InterlockedExchange(&socketContext->ControlOpQueued, TRUE) == FALSE) {
+        WskSampleEnqueueOp(
+            &socketContext->OpContext[WSKSAMPLE_CONTROL_OP],
+            (Flags & WSK_FLAG_ABORTIVE) ? WskSampleOpClose :
+                                          WskSampleOpDisconnect);
+    }
+
+    return STATUS_SUCCESS;
+}
+
 // Operation handler for issuing a disconnect request on a connected socket
 VOID
 WskSampleOpDisconnect(
@@ -1268,6 +1712,10 @@ WskSampleOpClose(
 
     socketContext = SocketOpContext->SocketContext;
 
+    // Return any data indications retained by this operation context. The
+    // socket may already be closing if a send of them was outstanding.
+    WskSampleReleaseIndication(SocketOpContext);
+
     if(socketContext->Closing) {
         // Do not call WskClose if socket is already being closed.
         // A close operation may get enqueued multiple times as a result
@@ -1356,6 +1804,7 @@ WskSampleOpFree(
     DoTraceMessage(TRCINFO, "OpFree: %p %p", socketContext, SocketOpContext);
 
     ASSERT(socketContext->Closing || socketContext->StopListening);
+    ASSERT(socketContext->OpContext[WSKSAMPLE_ECHO_OP].DataIndication == NULL);
     WskSampleFreeSocketContext(socketContext);
 }
 
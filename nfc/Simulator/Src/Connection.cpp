@@ -62,8 +62,9 @@ void CConnection::Terminate()
     if (PriorState != TERMINATED) {
         shutdown(_Socket, SD_SEND);
         
-        if (_ThreadpoolThreadId != GetCurrentThreadId()) {
-            WaitForThreadpoolWorkCallbacks(_ThreadpoolWork, false);
+        // Waits for the outstanding receive, which completes once the peer closes its end
+        if ((_ThreadpoolIo != nullptr) && (_ThreadpoolThreadId != GetCurrentThreadId())) {
+            WaitForThreadpoolIoCallbacks(_ThreadpoolIo, false);
         }
         
         SOCKET Socket = (SOCKET)InterlockedExchangePointer((PVOID*)&_Socket, (PVOID)INVALID_SOCKET);
@@ -205,48 +206,106 @@ HRESULT CConnection::FinalizeEstablish(_In_ SOCKET Socket)
     }
     
     if (SUCCEEDED(hr)) {
-        _ThreadpoolWork = CreateThreadpoolWork(s_ReceiveThreadProc, this, nullptr);
+        _pbReceiveBuffer = new BYTE[CONNECTION_RECEIVE_BATCH * sizeof(MESSAGE)];
 
-        if (_ThreadpoolWork == nullptr) {
+        if (_pbReceiveBuffer == nullptr) {
+            hr = E_OUTOFMEMORY;
+        }
+    }
+
+    if (SUCCEEDED(hr)) {
+        if (Socket != INVALID_SOCKET) {
+            _Socket = Socket;
+        }
+
+        // Receives complete on the threadpool's completion port, so no thread
+        // is tied up waiting on an idle connection
+        _ThreadpoolIo = CreateThreadpoolIo((HANDLE)_Socket, s_ReceiveThreadProc, this, nullptr);
+
+        if (_ThreadpoolIo == nullptr) {
             hr = HRESULT_FROM_WIN32(GetLastError());
         }
         else {
-            if (Socket != INVALID_SOCKET) {
-                _Socket = Socket;
+            hr = BeginReceive();
+
+            if (FAILED(hr)) {
+                CloseThreadpoolIo(_ThreadpoolIo);
+                _ThreadpoolIo = nullptr;
             }
+        }
 
-            SubmitThreadpoolWork(_ThreadpoolWork);
+        if (SUCCEEDED(hr)) {
             _pCallback->ConnectionEstablished(this);
         }
+        else if (Socket != INVALID_SOCKET) {
+            // The caller closes the socket it passed in
+            _Socket = INVALID_SOCKET;
+        }
     }
     
     MethodReturnHR(hr);
 }
 
-BOOL CConnection::ReceiveThreadProc()
+HRESULT CConnection::BeginReceive()
 {
     MethodEntry("void");
 
-    MESSAGE* pMessage = new MESSAGE();
+    HRESULT hr = S_OK;
+    PTP_IO threadpoolIo = _ThreadpoolIo;
+    WSABUF Buffer;
+    DWORD dwFlags = 0;
 
-    if (pMessage == nullptr) {
-        Terminate();
+    Buffer.buf = (char*)(_pbReceiveBuffer + _cbReceived);
+    Buffer.len = (ULONG)(CONNECTION_RECEIVE_BATCH * sizeof(MESSAGE)) - _cbReceived;
+
+    StartThreadpoolIo(threadpoolIo);
+    ZeroMemory(&_Overlapped, sizeof(_Overlapped));
+
+    if (WSARecv(_Socket, &Buffer, 1, nullptr, &dwFlags, &_Overlapped, nullptr) == SOCKET_ERROR) {
+        hr = HRESULT_FROM_WIN32(WSAGetLastError());
+
+        if (hr == HRESULT_FROM_WIN32(WSA_IO_PENDING)) {
+            hr = S_OK;
+        }
+        else {
+            CancelThreadpoolIo(threadpoolIo);
+        }
     }
-    else
-    {
-        while (_Socket != INVALID_SOCKET) {
-            if (recv(_Socket, (char*)pMessage, sizeof(*pMessage), MSG_WAITALL) == sizeof(*pMessage)) {
-                _pCallback->HandleReceivedMessage(_ConnectionType, pMessage);
-            }
-            else {
-                Terminate();
-                break;
-            }
+
+    MethodReturnHR(hr);
+}
+
+BOOL CConnection::ReceiveThreadProc(_In_ HRESULT hr, _In_ ULONG_PTR cbReceived)
+{
+    MethodEntry("hr = %!HRESULT!, cbReceived = %d", hr, (ULONG)cbReceived);
+
+    BOOL fConnectionDeleted = FALSE;
+
+    if (SUCCEEDED(hr) && (cbReceived == 0)) {
+        // The peer closed the connection
+        hr = HRESULT_FROM_WIN32(WSAEDISCON);
+    }
+
+    if (SUCCEEDED(hr)) {
+        _cbReceived += (DWORD)cbReceived;
+
+        DWORD cMessages = _cbReceived / sizeof(MESSAGE);
+
+        if (cMessages > 0) {
+            _pCallback->HandleReceivedMessages(_ConnectionType, (MESSAGE*)_pbReceiveBuffer, cMessages);
+
+            // Keep the start of a partially received message for the next read
+            _cbReceived -= cMessages * sizeof(MESSAGE);
+            MoveMemory(_pbReceiveBuffer, _pbReceiveBuffer + (cMessages * sizeof(MESSAGE)), _cbReceived);
         }
-        delete pMessage;
+
+        hr = BeginReceive();
     }
 
-    BOOL fConnectionDeleted = _pCallback->ConnectionTerminated(this);
+    if (FAILED(hr)) {
+        Terminate();
+        fConnectionDeleted = _pCallback->ConnectionTerminated(this);
+    }
 
     MethodReturnBool(fConnectionDeleted);
 }
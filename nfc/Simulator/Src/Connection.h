@@ -25,11 +25,15 @@ enum CONNECTION_TYPE
 class IConnectionCallback
 {
 public:
-    virtual void HandleReceivedMessage(_In_ CONNECTION_TYPE ConnType, _In_ MESSAGE* pMessage) = 0;
+    virtual void HandleReceivedMessages(_In_ CONNECTION_TYPE ConnType, _In_reads_(cMessages) MESSAGE* pMessages, _In_ DWORD cMessages) = 0;
     virtual void ConnectionEstablished(_In_ CConnection* pConnection) = 0;
     virtual BOOL ConnectionTerminated(_In_ CConnection* pConnection) = 0;
 };
 
+// Most messages a connection receives with one read and hands to
+// IConnectionCallback::HandleReceivedMessages together
+#define CONNECTION_RECEIVE_BATCH 4
+
 class CConnection : public IValidateAccept
 {
 private:
@@ -37,24 +41,32 @@ private:
         _State(INITIAL),
         _Socket(INVALID_SOCKET),
         _pCallback(pCallback),
-        _ThreadpoolWork(nullptr),
+        _ThreadpoolIo(nullptr),
+        _ThreadpoolThreadId(0),
+        _pbReceiveBuffer(nullptr),
+        _cbReceived(0),
         _fInboundConnection(false),
         _ConnectionType(CONNECTION_TYPE_P2P)
-    {}
+    {
+        ZeroMemory(&_Overlapped, sizeof(_Overlapped));
+    }
 
 public:
     virtual ~CConnection()
     {
         Terminate();
         
-        if (_ThreadpoolWork != nullptr) {
+        if (_ThreadpoolIo != nullptr) {
             // Don't wait for threadpool callbacks when this thread is actually the threadpool callback
             if (_ThreadpoolThreadId != GetCurrentThreadId()) {
-                WaitForThreadpoolWorkCallbacks(_ThreadpoolWork, false);
+                WaitForThreadpoolIoCallbacks(_ThreadpoolIo, false);
             }
-            CloseThreadpoolWork(_ThreadpoolWork);
-            _ThreadpoolWork = nullptr;
+            CloseThreadpoolIo(_ThreadpoolIo);
+            _ThreadpoolIo = nullptr;
         }
+
+        delete [] _pbReceiveBuffer;
+        _pbReceiveBuffer = nullptr;
     }
     
     static BOOL Create(_In_ IConnectionCallback* pCallback, _Outptr_result_maybenull_ CConnection** ppConnection);
@@ -69,18 +81,19 @@ public:
     HRESULT InitializeAsClient(_In_ BEGIN_PROXIMITY_ARGS* pArgs);
     HRESULT TransmitMessage(_In_ MESSAGE* pMessage);
 
-    BOOL ReceiveThreadProc();
+    BOOL ReceiveThreadProc(_In_ HRESULT hr, _In_ ULONG_PTR cbReceived);
 
     static VOID CALLBACK s_ReceiveThreadProc(
-        _Inout_     PTP_CALLBACK_INSTANCE Instance,
-        _Inout_     PVOID                 Context,
-        _Inout_     PTP_WORK              /*Work*/)
+        _Inout_      PTP_CALLBACK_INSTANCE /*Instance*/,
+        _Inout_      PVOID                 Context,
+        _Inout_opt_  PVOID                 /*Overlapped*/,
+        _In_         ULONG                 IoResult,
+        _In_         ULONG_PTR             NumberOfBytesTransferred,
+        _Inout_      PTP_IO                /*Io*/)
     {
-        CallbackMayRunLong(Instance);
-        
         CConnection* pConnection = (CConnection*)Context;
         pConnection->_ThreadpoolThreadId = GetCurrentThreadId();
-        BOOL fConnectionDeleted = pConnection->ReceiveThreadProc();
+        BOOL fConnectionDeleted = pConnection->ReceiveThreadProc(HRESULT_FROM_WIN32(IoResult), NumberOfBytesTransferred);
 
         if (!fConnectionDeleted) {
             // Only clear the member variable if the connection object wasn't deleted.
@@ -101,6 +114,7 @@ public:
 
 private:
     void Terminate();
+    HRESULT BeginReceive();
     
 private:
     enum STATE
@@ -112,8 +126,11 @@ private:
 
     volatile STATE          _State;
     SOCKET                  _Socket;
-    PTP_WORK                _ThreadpoolWork;
+    PTP_IO                  _ThreadpoolIo;
     DWORD                   _ThreadpoolThreadId;
+    OVERLAPPED              _Overlapped;
+    PBYTE                   _pbReceiveBuffer;   // room for CONNECTION_RECEIVE_BATCH messages
+    DWORD                   _cbReceived;        // bytes of _pbReceiveBuffer filled
     IConnectionCallback*    _pCallback;
     bool                    _fInboundConnection;
     LIST_ENTRY              _ListEntry;
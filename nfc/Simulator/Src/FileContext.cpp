@@ -36,6 +36,7 @@ CFileObject::CFileObject(
 
     InitializeListHead(&m_Queue);
     InitializeListHead(&m_ListEntry);
+    InitializeListHead(&m_TypeListEntry);
     InitializeCriticalSection(&m_RoleLock);
 
     RtlZeroMemory(&m_SecureElementId, sizeof(GUID));
@@ -226,6 +226,14 @@ public:
     {
         return (CFileObject*) CONTAINING_RECORD(pEntry, CFileObject, m_ListEntry);
     }
+    PLIST_ENTRY GetTypeListEntry()
+    {
+        return &m_TypeListEntry;
+    }
+    static CFileObject* FromTypeListEntry(PLIST_ENTRY pEntry)
+    {
+        return (CFileObject*) CONTAINING_RECORD(pEntry, CFileObject, m_TypeListEntry);
+    }
 
 private:
     void HandleReceivedMessage(_In_ DWORD cbPayload, _In_reads_bytes_(cbPayload) PBYTE pbPayload);
@@ -261,6 +269,7 @@ private:
     WDFREQUEST                  m_Request;                // Pended "Get Next" Request
     CRITICAL_SECTION            m_RoleLock;
     LIST_ENTRY                  m_ListEntry;
+    LIST_ENTRY                  m_TypeListEntry;          // Unique to ROLE_SUBSCRIPTION, entry in the queue's subscription index
     GUID                        m_SecureElementId;        // Unique to ROLE_SECUREELEMENTEVENT
     SECURE_ELEMENT_EVENT_TYPE   m_SecureElementEventType; // Unique to ROLE_SECUREELEMENTEVENT
 };
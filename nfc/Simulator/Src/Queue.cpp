@@ -38,6 +38,11 @@ CQueue::CQueue(WDFQUEUE Queue) :
     NT_ASSERT(m_Queue != nullptr);
 
     InitializeListHead(&m_SubsList);
+
+    for (int i = 0; i < SubsIndexBuckets; i++) {
+        InitializeListHead(&m_SubsIndex[i]);
+    }
+
     InitializeListHead(&m_ArrivalSubsList);
     InitializeListHead(&m_DepartureSubsList);
     InitializeListHead(&m_PubsList);
@@ -428,6 +433,7 @@ CQueue::OnFileCreate(
     if (pFileObject->IsNormalSubscription()) {
         EnterCriticalSection(&m_SubsLock);
         InsertHeadList(&m_SubsList, pFileObject->GetListEntry());
+        InsertHeadList(&m_SubsIndex[GetSubsIndexBucket(pFileObject->GetType(), MaxCchType)], pFileObject->GetTypeListEntry());
         LeaveCriticalSection(&m_SubsLock);
     }
     else if (pFileObject->IsArrivedSubscription()) {
@@ -512,6 +518,11 @@ void CQueue::OnFileClose(_In_ WDFFILEOBJECT FileObject)
                 break;
             }
         }
+
+        if (pHead == &m_SubsList) {
+            RemoveEntryList(pFileObject->GetTypeListEntry());
+            InitializeListHead(pFileObject->GetTypeListEntry());
+        }
         LeaveCriticalSection(pLock);
     }
 
@@ -2188,29 +2199,70 @@ void CQueue::HandleRemovalEvent()
     MethodReturnVoid();
 }
 
-void CQueue::HandleReceivedMessage(_In_ CONNECTION_TYPE ConnType, _In_ MESSAGE* pMessage)
+DWORD CQueue::GetSubsIndexBucket(_In_reads_or_z_opt_(cchMax) PCWSTR pszType, _In_ size_t cchMax)
 {
-    MethodEntry("pMessage->m_szType = '%S'", pMessage->m_szType);
+    // FNV-1a over the type; matching is case-sensitive so no case folding
+    DWORD Hash = 2166136261;
+
+    if (pszType != nullptr) {
+        for (size_t i = 0; (i < cchMax) && (pszType[i] != L'\0'); i++) {
+            Hash = (Hash ^ pszType[i]) * 16777619;
+        }
+    }
+
+    return Hash % SubsIndexBuckets;
+}
+
+void CQueue::DeliverToSubsIndexBucket(_In_ DWORD Bucket, _In_ MESSAGE* pMessage)
+{
+    // Types that share the bucket are filtered out by CFileObject::HandleReceivedMessage
+    for (LIST_ENTRY* pEntry = m_SubsIndex[Bucket].Flink; pEntry != &m_SubsIndex[Bucket]; pEntry = pEntry->Flink) {
+        CFileObject* pSub = CFileObject::FromTypeListEntry(pEntry);
+        pSub->HandleReceivedMessage(pMessage->m_szType, pMessage->m_cbPayload, pMessage->m_Payload);
+    }
+}
+
+void CQueue::HandleReceivedMessages(_In_ CONNECTION_TYPE ConnType, _In_reads_(cMessages) MESSAGE* pMessages, _In_ DWORD cMessages)
+{
+    MethodEntry("cMessages = %d, pMessages->m_szType = '%S'", cMessages, pMessages->m_szType);
 
     if (ConnType == CONNECTION_TYPE_P2P) {
-        if ((pMessage->m_cbPayload > 0) && (pMessage->m_cbPayload <= MaxCbPayload)) {
-            EnterCriticalSection(&m_SubsLock);
+        DWORD MimeBucket = GetSubsIndexBucket(WINDOWSMIME_PROTOCOL, WINDOWSMIME_PROTOCOL_CHARS);
+
+        // Take the subscription lock once for the whole batch; each subscriber
+        // still sees the messages in the order they were received
+        EnterCriticalSection(&m_SubsLock);
+
+        for (DWORD i = 0; i < cMessages; i++) {
+            MESSAGE* pMessage = &pMessages[i];
 
-            for (LIST_ENTRY* pEntry = m_SubsList.Flink; pEntry != &m_SubsList; pEntry = pEntry->Flink) {
-                CFileObject* pSub = CFileObject::FromListEntry(pEntry);
-                pSub->HandleReceivedMessage(pMessage->m_szType, pMessage->m_cbPayload, pMessage->m_Payload);
+            if ((pMessage->m_cbPayload > 0) && (pMessage->m_cbPayload <= MaxCbPayload)) {
+                DWORD Bucket = GetSubsIndexBucket(pMessage->m_szType, _countof(pMessage->m_szType));
+
+                DeliverToSubsIndexBucket(Bucket, pMessage);
+
+                // A "WindowsMime" subscription also receives every "WindowsMime.<type>" message
+                if ((Bucket != MimeBucket) &&
+                    (wcsnlen(pMessage->m_szType, _countof(pMessage->m_szType)) > WINDOWSMIME_PROTOCOL_CHARS) &&
+                    (CompareStringOrdinal(pMessage->m_szType, WINDOWSMIME_PROTOCOL_CHARS, WINDOWSMIME_PROTOCOL, -1, FALSE) == CSTR_EQUAL)) {
+                    DeliverToSubsIndexBucket(MimeBucket, pMessage);
+                }
             }
-            LeaveCriticalSection(&m_SubsLock);
         }
+        LeaveCriticalSection(&m_SubsLock);
     }
     else if (ConnType == CONNECTION_TYPE_TAG) {
-        m_SmartCardReader.MessageReceived(pMessage);
+        for (DWORD i = 0; i < cMessages; i++) {
+            m_SmartCardReader.MessageReceived(&pMessages[i]);
+        }
     }
     else if (ConnType == CONNECTION_TYPE_HCE) {
         EnterCriticalSection(&m_SEManagerLock);
 
         if (m_pSEManager != nullptr) {
-            m_pSEManager->HandleReceiveHcePacket((USHORT)m_HCEConnectionId, pMessage->m_cbPayload, pMessage->m_Payload);
+            for (DWORD i = 0; i < cMessages; i++) {
+                m_pSEManager->HandleReceiveHcePacket((USHORT)m_HCEConnectionId, pMessages[i].m_cbPayload, pMessages[i].m_Payload);
+            }
         }
         LeaveCriticalSection(&m_SEManagerLock);
     }
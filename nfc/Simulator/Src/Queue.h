@@ -28,6 +28,7 @@ static const int MaxCchTypeNetwork = 502;   // maximum message type length over
 static const int MinCchType = 2;
 static const int MaxCchMimeType = 256;
 static const int MaxSecureElements = 16;
+static const int SubsIndexBuckets = 64;     // normal subscriptions are also indexed by a hash of their type
 
 #define SIM_NAMESPACE                           L"Simulator"
 #define SIM_NAMESPACE_CHARS                     ARRAYSIZE(SIM_NAMESPACE) - 1
@@ -92,7 +93,7 @@ public:
     void ValidateAccept(_In_ SOCKET Socket, _In_ GUID* pMagicPacket);
 
     //IConnectionCallback
-    virtual void HandleReceivedMessage(_In_ CONNECTION_TYPE ConnType, _In_ MESSAGE* pMessageData);
+    virtual void HandleReceivedMessages(_In_ CONNECTION_TYPE ConnType, _In_reads_(cMessages) MESSAGE* pMessages, _In_ DWORD cMessages);
     virtual void ConnectionEstablished(_In_ CConnection* pConnection);
     virtual BOOL ConnectionTerminated(_In_ CConnection* pConnection);
 
@@ -183,8 +184,12 @@ private:
     
     BOOL ValidateMessage(_In_ CFileObject *pFileObject, _In_ ULONG IoControlCode);
 
+    static DWORD GetSubsIndexBucket(_In_reads_or_z_opt_(cchMax) PCWSTR pszType, _In_ size_t cchMax);
+    void DeliverToSubsIndexBucket(_In_ DWORD Bucket, _In_ MESSAGE* pMessage);
+
     WDFQUEUE             m_Queue;
     LIST_ENTRY           m_SubsList;
+    LIST_ENTRY           m_SubsIndex[SubsIndexBuckets];
     LIST_ENTRY           m_ArrivalSubsList;
     LIST_ENTRY           m_DepartureSubsList;
     CRITICAL_SECTION     m_SubsLock;
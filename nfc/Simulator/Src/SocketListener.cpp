@@ -46,7 +46,8 @@ HRESULT CSocketListener::EnableAccepting()
         }
 
         if (SUCCEEDED(hr)) {
-            if (listen(_ListenSocket, 2) == SOCKET_ERROR) {
+            // Many simulated peers may connect at once
+            if (listen(_ListenSocket, SOMAXCONN) == SOCKET_ERROR) {
                 hr = HRESULT_FROM_WIN32(WSAGetLastError());
             }
         }
@@ -0,0 +1,393 @@
+/*++
+
+Copyright (c) Microsoft Corporation. All rights reserved.
+
+Module Name:
+
+    idle.c
+
+Abstract:
+
+    This module implements the idle residency predictor used to select
+    component idle states.
+
+    Each predictor keeps an exponential histogram of the idle periods
+    observed for one component: bucket N counts periods of
+    [2^N, 2^(N + 1)) microseconds. The histogram is halved every
+    PEP_IDLE_HISTOGRAM_DECAY_INTERVAL samples so that it follows changes
+    in the workload. The predicted idle duration is the shortest period
+    that PEP_IDLE_PREDICTOR_CONFIDENCE percent of the recent periods
+    reached, and the deepest idle state whose exit latency fits the
+    latency tolerance and whose residency requirement fits the prediction
+    is selected.
+
+
+Environment:
+
+    Kernel Mode
+
+--*/
+
+//
+//-------------------------------------------------------------------- Includes
+//
+
+#include "pch.h"
+
+#if defined(EVENT_TRACING)
+#include "idle.tmh"
+#endif
+
+//
+//----------------------------------------------------------------- Prototypes
+//
+
+ULONG
+PepIdleDurationToBucket (
+    _In_ ULONGLONG Duration
+    );
+
+ULONGLONG
+PepIdlePredictDuration (
+    _In_ PPEP_IDLE_PREDICTOR Predictor
+    );
+
+//
+//------------------------------------------------------------------- Functions
+//
+
+VOID
+PepIdlePredictorInitialize (
+    _Out_ PPEP_IDLE_PREDICTOR Predictor,
+    _In_ ULONGLONG LatencyTolerance
+    )
+
+/*++
+
+Routine Description:
+
+    This routine initializes an idle residency predictor with an empty
+    history.
+
+Arguments:
+
+    Predictor - Supplies a pointer to the predictor to initialize.
+
+    LatencyTolerance - Supplies the longest exit latency, in 100ns units,
+        that the device tolerates. PEP_IDLE_LATENCY_TOLERANCE_ANY places
+        no limit.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    RtlZeroMemory(Predictor, sizeof(PEP_IDLE_PREDICTOR));
+    Predictor->LatencyTolerance = LatencyTolerance;
+    return;
+}
+
+VOID
+PepIdlePredictorSetLatencyTolerance (
+    _Inout_ PPEP_IDLE_PREDICTOR Predictor,
+    _In_ ULONGLONG LatencyTolerance
+    )
+
+/*++
+
+Routine Description:
+
+    This routine updates the latency tolerance of a predictor, typically in
+    response to a latency change requested by the device driver. The
+    history is kept.
+
+Arguments:
+
+    Predictor - Supplies a pointer to the predictor.
+
+    LatencyTolerance - Supplies the longest exit latency, in 100ns units,
+        that the device tolerates.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    Predictor->LatencyTolerance = LatencyTolerance;
+    return;
+}
+
+ULONG
+PepIdlePredictorSelectState (
+    _Inout_ PPEP_IDLE_PREDICTOR Predictor,
+    _In_ ULONG IdleStateCount,
+    _In_reads_(IdleStateCount) PPO_FX_COMPONENT_IDLE_STATE IdleStates
+    )
+
+/*++
+
+Routine Description:
+
+    This routine selects the idle state for the idle period that is about
+    to begin. The caller is responsible for serializing calls for the same
+    predictor, typically with the device lock.
+
+Arguments:
+
+    Predictor - Supplies a pointer to the predictor of the component.
+
+    IdleStateCount - Supplies the number of idle states of the component.
+
+    IdleStates - Supplies the idle states of the component, F0 first. Deeper
+        states are expected to have longer exit latencies.
+
+Return Value:
+
+    The index of the selected idle state. F0 is returned if no deeper state
+    fits.
+
+--*/
+
+{
+
+    ULONGLONG Predicted;
+    ULONG State;
+
+    NT_ASSERT(IdleStateCount > 0);
+
+    Predicted = PepIdlePredictDuration(Predictor);
+    Predictor->PredictedDuration = Predicted;
+    Predictor->SelectedState = 0;
+    for (State = IdleStateCount - 1; State > 0; State -= 1) {
+        if (IdleStates[State].TransitionLatency > Predictor->LatencyTolerance) {
+            continue;
+        }
+
+        if (IdleStates[State].ResidencyRequirement > Predicted) {
+            continue;
+        }
+
+        Predictor->SelectedState = State;
+        break;
+    }
+
+    Predictor->Selections += 1;
+    return Predictor->SelectedState;
+}
+
+VOID
+PepIdlePredictorRecordIdle (
+    _Inout_ PPEP_IDLE_PREDICTOR Predictor,
+    _In_ ULONG IdleStateCount,
+    _In_reads_(IdleStateCount) PPO_FX_COMPONENT_IDLE_STATE IdleStates,
+    _In_ ULONGLONG Duration
+    )
+
+/*++
+
+Routine Description:
+
+    This routine records the length of the idle period that just ended and
+    checks it against the state selected for it. The caller is responsible
+    for serializing calls for the same predictor.
+
+Arguments:
+
+    Predictor - Supplies a pointer to the predictor of the component.
+
+    IdleStateCount - Supplies the number of idle states of the component.
+
+    IdleStates - Supplies the idle states of the component, F0 first.
+
+    Duration - Supplies the length of the idle period, in 100ns units.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Bucket;
+    ULONG Deeper;
+    ULONG Selected;
+
+    Selected = Predictor->SelectedState;
+    NT_ASSERT(Selected < IdleStateCount);
+
+    //
+    // The selection was too deep if the period ended before the selected
+    // state broke even, so power was spent on a transition that did not pay
+    // off and the device paid the exit latency for nothing.
+    //
+
+    if ((Selected > 0) &&
+        (Duration < IdleStates[Selected].ResidencyRequirement)) {
+
+        Predictor->TooDeep += 1;
+        TraceEvents(INFO,
+                    DBG_PEP,
+                    "%s: Idle state F%d too deep. Idle %I64d, predicted %I64d, "
+                    "residency %I64d (100ns). Too deep count = %d.\n",
+                    __FUNCTION__,
+                    Selected,
+                    Duration,
+                    Predictor->PredictedDuration,
+                    IdleStates[Selected].ResidencyRequirement,
+                    Predictor->TooDeep);
+
+    } else {
+
+        //
+        // The selection was too shallow if a deeper state within the latency
+        // tolerance would have broken even during this period.
+        //
+
+        for (Deeper = IdleStateCount - 1; Deeper > Selected; Deeper -= 1) {
+            if ((IdleStates[Deeper].TransitionLatency <=
+                 Predictor->LatencyTolerance) &&
+                (IdleStates[Deeper].ResidencyRequirement <= Duration)) {
+
+                Predictor->TooShallow += 1;
+                TraceEvents(INFO,
+                            DBG_PEP,
+                            "%s: Idle state F%d too shallow, F%d fit. "
+                            "Idle %I64d, predicted %I64d (100ns). "
+                            "Too shallow count = %d.\n",
+                            __FUNCTION__,
+                            Selected,
+                            Deeper,
+                            Duration,
+                            Predictor->PredictedDuration,
+                            Predictor->TooShallow);
+
+                break;
+            }
+        }
+    }
+
+    //
+    // Age the history before adding the new sample.
+    //
+
+    Predictor->SampleCount += 1;
+    if (Predictor->SampleCount >= PEP_IDLE_HISTOGRAM_DECAY_INTERVAL) {
+        Predictor->SampleCount = 0;
+        for (Bucket = 0; Bucket < PEP_IDLE_HISTOGRAM_BUCKETS; Bucket += 1) {
+            Predictor->Histogram[Bucket] >>= 1;
+        }
+    }
+
+    Bucket = PepIdleDurationToBucket(Duration);
+    Predictor->Histogram[Bucket] += PEP_IDLE_HISTOGRAM_SAMPLE_WEIGHT;
+    return;
+}
+
+ULONG
+PepIdleDurationToBucket (
+    _In_ ULONGLONG Duration
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the histogram bucket of an idle period.
+
+Arguments:
+
+    Duration - Supplies the length of the idle period, in 100ns units.
+
+Return Value:
+
+    The bucket index. Periods longer than the histogram covers land in the
+    last bucket.
+
+--*/
+
+{
+
+    ULONG Bucket;
+    ULONGLONG Microseconds;
+
+    Microseconds = Duration / 10;
+    if (Microseconds == 0) {
+        return 0;
+    }
+
+    BitScanReverse64(&Bucket, Microseconds);
+    if (Bucket >= PEP_IDLE_HISTOGRAM_BUCKETS) {
+        Bucket = PEP_IDLE_HISTOGRAM_BUCKETS - 1;
+    }
+
+    return Bucket;
+}
+
+ULONGLONG
+PepIdlePredictDuration (
+    _In_ PPEP_IDLE_PREDICTOR Predictor
+    )
+
+/*++
+
+Routine Description:
+
+    This routine predicts the length of the next idle period from the
+    histogram.
+
+Arguments:
+
+    Predictor - Supplies a pointer to the predictor.
+
+Return Value:
+
+    The lower bound, in 100ns units, of the shortest bucket such that
+    PEP_IDLE_PREDICTOR_CONFIDENCE percent of the recorded periods were at
+    least that long. MAXULONGLONG if nothing has been recorded yet, so
+    that the first selection is limited only by the latency tolerance.
+
+--*/
+
+{
+
+    ULONG Bucket;
+    ULONGLONG Cumulative;
+    ULONGLONG Total;
+
+    Total = 0;
+    for (Bucket = 0; Bucket < PEP_IDLE_HISTOGRAM_BUCKETS; Bucket += 1) {
+        Total += Predictor->Histogram[Bucket];
+    }
+
+    if (Total == 0) {
+        return MAXULONGLONG;
+    }
+
+    //
+    // Walk down from the longest periods until enough of the history is
+    // covered.
+    //
+
+    Cumulative = 0;
+    Bucket = PEP_IDLE_HISTOGRAM_BUCKETS;
+    while (Bucket > 0) {
+        Bucket -= 1;
+        Cumulative += Predictor->Histogram[Bucket];
+        if ((Cumulative * 100) >= (Total * PEP_IDLE_PREDICTOR_CONFIDENCE)) {
+            break;
+        }
+    }
+
+    if (Bucket == 0) {
+        return 0;
+    }
+
+    return (1ULL << Bucket) * 10;
+}
@@ -170,6 +170,17 @@ Abstract:
 #define ACPI_OBJECT_NAME_PLD  ((ULONG)'DLP_')
 #define ACPI_OBJECT_NAME_REV  ((ULONG)'VER_')
 
+//
+// Idle residency predictor. Bucket N of the histogram counts idle periods of
+// [2^N, 2^(N + 1)) microseconds; 24 buckets cover periods up to ~16 seconds.
+//
+
+#define PEP_IDLE_HISTOGRAM_BUCKETS 24
+#define PEP_IDLE_HISTOGRAM_SAMPLE_WEIGHT 16
+#define PEP_IDLE_HISTOGRAM_DECAY_INTERVAL 64
+#define PEP_IDLE_PREDICTOR_CONFIDENCE 80
+#define PEP_IDLE_LATENCY_TOLERANCE_ANY MAXULONGLONG
+
 #define NAME_NATIVE_METHOD(_Name) (((_Name) == NULL) ? "Unknown" : (_Name))
 #define NAME_DEBUG_INFO(_Info) (((_Info) == NULL) ? "" : (_Info))
 
@@ -319,6 +330,28 @@ typedef struct _PEP_ACPI_DEVICE {
     PEP_INTERNAL_DEVICE_HEADER Header;
 } PEP_ACPI_DEVICE, *PPEP_ACPI_DEVICE;
 
+//
+// Per-component idle residency predictor. DPM-owned device contexts keep one
+// per component and protect it with the device lock. The counters are traced
+// on every misprediction.
+//
+
+typedef struct _PEP_IDLE_PREDICTOR {
+    ULONG Histogram[PEP_IDLE_HISTOGRAM_BUCKETS];
+    ULONG SampleCount;
+    ULONGLONG LatencyTolerance;
+    ULONGLONG PredictedDuration;
+    ULONG SelectedState;
+
+    //
+    // Statistics
+    //
+
+    ULONG Selections;
+    ULONG TooDeep;
+    ULONG TooShallow;
+} PEP_IDLE_PREDICTOR, *PPEP_IDLE_PREDICTOR;
+
 typedef enum _PEP_NOTIFICATION_CLASS {
     PEP_NOTIFICATION_CLASS_NONE = 0,
     PEP_NOTIFICATION_CLASS_ACPI = 1,
@@ -511,6 +544,37 @@ PepEvtDriverUnload (
     _In_ WDFDRIVER Driver
     );
 
+//
+// idle.c
+//
+
+VOID
+PepIdlePredictorInitialize (
+    _Out_ PPEP_IDLE_PREDICTOR Predictor,
+    _In_ ULONGLONG LatencyTolerance
+    );
+
+VOID
+PepIdlePredictorSetLatencyTolerance (
+    _Inout_ PPEP_IDLE_PREDICTOR Predictor,
+    _In_ ULONGLONG LatencyTolerance
+    );
+
+ULONG
+PepIdlePredictorSelectState (
+    _Inout_ PPEP_IDLE_PREDICTOR Predictor,
+    _In_ ULONG IdleStateCount,
+    _In_reads_(IdleStateCount) PPO_FX_COMPONENT_IDLE_STATE IdleStates
+    );
+
+VOID
+PepIdlePredictorRecordIdle (
+    _Inout_ PPEP_IDLE_PREDICTOR Predictor,
+    _In_ ULONG IdleStateCount,
+    _In_reads_(IdleStateCount) PPO_FX_COMPONENT_IDLE_STATE IdleStates,
+    _In_ ULONGLONG Duration
+    );
+
 //
 // util.c
 //
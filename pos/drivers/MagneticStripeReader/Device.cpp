@@ -4,6 +4,7 @@
 #include "PosEvents.h"
 #include "Ioctl.h"
 #include "IoRead.h"
+#include "PosEventRing.h"
 
 /*
 ** Driver TODO: Complete the implementation of EvtDriverDeviceAdd for your specific device.
@@ -77,14 +78,21 @@ NTSTATUS EvtDriverDeviceAdd(_In_ WDFDRIVER /* UnusedDriver */, _Inout_ PWDFDEVIC
         return status;
     }
 
-    // Set up an IO queue to handle DeviceIoControl and ReadFile
+    // Preallocate the ring that MSR events are queued to before they are pended to PosCx (see PosEventRing.cpp)
+    status = PosEventRingCreate(device, MSR_INTERFACE_TAG);
+
+    if (!NT_SUCCESS(status))
+    {
+        return status;
+    }
+
+    // Set up an IO queue to handle DeviceIoControl
     WDF_IO_QUEUE_CONFIG queueConfig;
     WDF_OBJECT_ATTRIBUTES attributes;
     WDFQUEUE queue;
 
     WDF_IO_QUEUE_CONFIG_INIT_DEFAULT_QUEUE(&queueConfig, WdfIoQueueDispatchSequential);
     queueConfig.EvtIoDeviceControl = EvtIoDeviceControl;
-    queueConfig.EvtIoRead = EvtIoRead;
 
     // Call us in PASSIVE_LEVEL
     WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
@@ -97,5 +105,31 @@ NTSTATUS EvtDriverDeviceAdd(_In_ WDFDRIVER /* UnusedDriver */, _Inout_ PWDFDEVIC
         &queue
         );
 
+    if (!NT_SUCCESS(status))
+    {
+        return status;
+    }
+
+    // Reads get their own parallel queue, so that during a burst of swipes a read that the runtime re-issues is handed to
+    // PosCx right away instead of waiting behind property requests on the sequential queue.
+    WDFQUEUE readQueue;
+
+    WDF_IO_QUEUE_CONFIG_INIT(&queueConfig, WdfIoQueueDispatchParallel);
+    queueConfig.EvtIoRead = EvtIoRead;
+
+    status = WdfIoQueueCreate(
+        device,
+        &queueConfig,
+        &attributes,
+        &readQueue
+        );
+
+    if (!NT_SUCCESS(status))
+    {
+        return status;
+    }
+
+    status = WdfDeviceConfigureRequestDispatching(device, readQueue, WdfRequestTypeRead);
+
     return status;
 }
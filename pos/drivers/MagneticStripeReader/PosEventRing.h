@@ -0,0 +1,43 @@
+#pragma once
+
+// Number of events that can be queued between two flushes, and the largest event (in bytes) that fits in one slot
+#ifndef POS_EVENT_RING_SLOT_COUNT
+#define POS_EVENT_RING_SLOT_COUNT 64
+#endif
+
+#ifndef POS_EVENT_RING_SLOT_SIZE
+#define POS_EVENT_RING_SLOT_SIZE  2048
+#endif
+
+typedef struct _POS_EVENT_RING_SLOT
+{
+    PosEventType EventType;
+    ULONG Attributes;
+    BOOLEAN DataIncludesHeader;
+    ULONG DataLength;
+    BYTE Data[POS_EVENT_RING_SLOT_SIZE];
+} POS_EVENT_RING_SLOT;
+
+typedef struct _POS_EVENT_RING
+{
+    ULONG InterfaceTag;
+    WDFSPINLOCK Lock;
+    WDFWORKITEM FlushWorkItem;
+    POS_EVENT_RING_SLOT* Slots;
+    ULONG Head;
+    ULONG Count;
+    ULONG DroppedEvents;
+} POS_EVENT_RING;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(POS_EVENT_RING, GetPosEventRing)
+
+NTSTATUS PosEventRingCreate(_In_ WDFDEVICE Device, _In_ ULONG InterfaceTag);
+
+NTSTATUS PosEventRingPut(
+    _In_ WDFDEVICE Device,
+    _In_ PosEventType EventType,
+    _In_reads_bytes_(DataLength) const VOID* Data,
+    _In_ ULONG DataLength,
+    _In_ ULONG Attributes,
+    _In_ BOOLEAN DataIncludesHeader
+    );
@@ -1,5 +1,7 @@
 #include <pch.h>
 
+#include "PosEventRing.h"
+
 /*
 ** Driver TODO:  Add code to EvtDeviceOwnershipChange to reset the device state to a default.
 **
@@ -36,15 +38,17 @@ VOID EvtOnMsrScanDataRetrieved(_In_ WDFDEVICE Device)
     
     // The following shows an example of sending MSR data
 
+    static_assert(sizeof(MSR_DATA_RECEIVED) <= POS_EVENT_RING_SLOT_SIZE, "MSR_DATA_RECEIVED does not fit in an event ring slot");
     MSR_DATA_RECEIVED dataReceivedEventInfo;
     
     // Fill in all the fields in MSR_DATA_RECEIVED
 
-    // This call actually pends the data to be send to the WinRT APIs.
-    NTSTATUS status = PosCxPutPendingEvent(Device, MSR_INTERFACE_TAG, PosEventType::MagneticStripeReaderDataReceived, sizeof(dataReceivedEventInfo), &dataReceivedEventInfo, POS_CX_EVENT_ATTR_DATA);
+    // This call queues the data to be sent to the WinRT APIs; the ring's work item pends it to PosCx (see PosEventRing.cpp).
+    // PosCx adds the event header, so DataIncludesHeader is FALSE.
+    NTSTATUS status = PosEventRingPut(Device, PosEventType::MagneticStripeReaderDataReceived, &dataReceivedEventInfo, sizeof(dataReceivedEventInfo), POS_CX_EVENT_ATTR_DATA, FALSE);
 
     if (!NT_SUCCESS(status))
     {
-        // This should only happen in rare cases such as out of memory (or that the device or interface tag isn't found).  The driver should most likely drop the event.
+        // This should only happen if the ring is full because events are queued faster than they can be pended.  The driver should most likely drop the event.
     }
 }
\ No newline at end of file
@@ -0,0 +1,200 @@
+#include <pch.h>
+
+#include "PosEventRing.h"
+
+EVT_WDF_WORKITEM EvtPosEventRingFlush;
+
+/*
+** Driver TODO:
+**
+** The event ring decouples reading data from the device from pending it to PosCx.  All of the slots are allocated once when
+** the device is added, so queuing an event during a burst of device data only copies it into the next free slot.  The first event
+** queued after a flush schedules a work item, and that work item pends every event that is queued by the time it runs, so a
+** burst costs one work item instead of one pass through PosCx per event.
+**
+** PosCx still completes each pending read with a single event, since that is what the runtime expects.
+** Adjust POS_EVENT_RING_SLOT_COUNT and POS_EVENT_RING_SLOT_SIZE to the burst rate and event size of your device.
+*/
+NTSTATUS PosEventRingCreate(_In_ WDFDEVICE Device, _In_ ULONG InterfaceTag)
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    POS_EVENT_RING* ring = nullptr;
+
+    WDF_OBJECT_ATTRIBUTES ringAttributes;
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&ringAttributes, POS_EVENT_RING);
+
+    status = WdfObjectAllocateContext(Device, &ringAttributes, (PVOID*)&ring);
+
+    if (!NT_SUCCESS(status))
+    {
+        return status;
+    }
+
+    ring->InterfaceTag = InterfaceTag;
+
+    WDF_OBJECT_ATTRIBUTES attributes;
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject = Device;
+
+    WDFMEMORY slotMemory = NULL;
+    status = WdfMemoryCreate(
+        &attributes,
+        NonPagedPoolNx,
+        (ULONG)'rEOP',
+        sizeof(POS_EVENT_RING_SLOT) * POS_EVENT_RING_SLOT_COUNT,
+        &slotMemory,
+        (PVOID*)&ring->Slots
+        );
+
+    if (!NT_SUCCESS(status))
+    {
+        return status;
+    }
+
+    status = WdfSpinLockCreate(&attributes, &ring->Lock);
+
+    if (!NT_SUCCESS(status))
+    {
+        return status;
+    }
+
+    WDF_WORKITEM_CONFIG workItemConfig;
+    WDF_WORKITEM_CONFIG_INIT(&workItemConfig, EvtPosEventRingFlush);
+
+    status = WdfWorkItemCreate(&workItemConfig, &attributes, &ring->FlushWorkItem);
+
+    return status;
+}
+
+/*
+** Queues an event to be pended to PosCx by the flush work item.  Data is copied, so the caller's buffer may be reused as
+** soon as this returns.  When DataIncludesHeader is TRUE, Data starts with the event header and is pended with
+** PosCxPutPendingEventMemory; otherwise PosCx adds the header through PosCxPutPendingEvent.
+**
+** Returns STATUS_INSUFFICIENT_RESOURCES if the ring is full, in which case the driver should most likely drop the event.
+*/
+NTSTATUS PosEventRingPut(
+    _In_ WDFDEVICE Device,
+    _In_ PosEventType EventType,
+    _In_reads_bytes_(DataLength) const VOID* Data,
+    _In_ ULONG DataLength,
+    _In_ ULONG Attributes,
+    _In_ BOOLEAN DataIncludesHeader
+    )
+{
+    POS_EVENT_RING* ring = GetPosEventRing(Device);
+    BOOLEAN scheduleFlush = FALSE;
+
+    if (DataLength > POS_EVENT_RING_SLOT_SIZE)
+    {
+        return STATUS_BUFFER_OVERFLOW;
+    }
+
+    WdfSpinLockAcquire(ring->Lock);
+
+    if (ring->Count == POS_EVENT_RING_SLOT_COUNT)
+    {
+        ring->DroppedEvents++;
+        WdfSpinLockRelease(ring->Lock);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    POS_EVENT_RING_SLOT* slot = &ring->Slots[(ring->Head + ring->Count) % POS_EVENT_RING_SLOT_COUNT];
+    slot->EventType = EventType;
+    slot->Attributes = Attributes;
+    slot->DataIncludesHeader = DataIncludesHeader;
+    slot->DataLength = DataLength;
+    memcpy(slot->Data, Data, DataLength);
+
+    // Only the first event of a burst needs to schedule the flush; the others are picked up by the same pass
+    scheduleFlush = (ring->Count == 0);
+    ring->Count++;
+
+    WdfSpinLockRelease(ring->Lock);
+
+    if (scheduleFlush)
+    {
+        WdfWorkItemEnqueue(ring->FlushWorkItem);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/*
+** Pends one queued event to PosCx.  The slot stays owned by the flush until it is released from the ring.
+*/
+static VOID PosEventRingDeliver(_In_ WDFDEVICE Device, _In_ ULONG InterfaceTag, _In_ POS_EVENT_RING_SLOT* Slot)
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    if (Slot->DataIncludesHeader)
+    {
+        WDF_OBJECT_ATTRIBUTES attributes;
+        WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+        attributes.ParentObject = Device;
+
+        BYTE* eventData = nullptr;
+        WDFMEMORY eventMemory = NULL;
+        status = WdfMemoryCreate(
+            &attributes,
+            NonPagedPoolNx,
+            (ULONG)'eSOP',
+            Slot->DataLength,
+            &eventMemory,
+            (PVOID*)&eventData
+            );
+
+        if (NT_SUCCESS(status))
+        {
+            memcpy(eventData, Slot->Data, Slot->DataLength);
+
+            status = PosCxPutPendingEventMemory(Device, InterfaceTag, eventMemory, Slot->Attributes);
+
+            if (!NT_SUCCESS(status))
+            {
+                WdfObjectDelete(eventMemory);
+            }
+        }
+    }
+    else
+    {
+        status = PosCxPutPendingEvent(Device, InterfaceTag, Slot->EventType, Slot->DataLength, Slot->Data, Slot->Attributes);
+    }
+
+    if (!NT_SUCCESS(status))
+    {
+        // This should only happen in rare cases such as out of memory (or that the device or interface tag isn't found).  The event is dropped.
+    }
+}
+
+_Use_decl_annotations_
+VOID EvtPosEventRingFlush(WDFWORKITEM WorkItem)
+{
+    WDFDEVICE device = (WDFDEVICE)WdfWorkItemGetParentObject(WorkItem);
+    POS_EVENT_RING* ring = GetPosEventRing(device);
+
+    for (;;)
+    {
+        POS_EVENT_RING_SLOT* slot = nullptr;
+
+        WdfSpinLockAcquire(ring->Lock);
+        if (ring->Count > 0)
+        {
+            slot = &ring->Slots[ring->Head];
+        }
+        WdfSpinLockRelease(ring->Lock);
+
+        if (slot == nullptr)
+        {
+            break;
+        }
+
+        // The producer only writes past the queued events, so the head slot can be read without holding the lock
+        PosEventRingDeliver(device, ring->InterfaceTag, slot);
+
+        WdfSpinLockAcquire(ring->Lock);
+        ring->Head = (ring->Head + 1) % POS_EVENT_RING_SLOT_COUNT;
+        ring->Count--;
+        WdfSpinLockRelease(ring->Lock);
+    }
+}
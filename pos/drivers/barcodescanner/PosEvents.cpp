@@ -1,5 +1,7 @@
 #include <pch.h>
 
+#include "PosEventRing.h"
+
 /*
 ** Driver TODO:  Add code to EvtDeviceOwnershipChange to reset the device state to a default.
 **
@@ -42,35 +44,17 @@ VOID EvtOnBarcodeScanDataRetrieved(_In_ WDFDEVICE Device)
     WCHAR exampleDataLabel[] = L"12345";
 
     // total size is the struct plus the size of the two strings (minus the null terminators which aren't transmitted).
-    size_t totalSize = sizeof(PosBarcodeScannerDataReceivedEventData) + sizeof(exampleData) - sizeof(WCHAR) + sizeof(exampleDataLabel) - sizeof(WCHAR);
+    const size_t totalSize = sizeof(PosBarcodeScannerDataReceivedEventData) + sizeof(exampleData) - sizeof(WCHAR) + sizeof(exampleDataLabel) - sizeof(WCHAR);
 
     
     // PosCx supports two methods of pending the event data -- one where it takes the WDFMEMORY for the event, and the other where it creates it
     // The subtle difference between the two is that the one that takes the WDFMEMORY must have the event header information already added.
     // 
-    // Since that's the case with the PosBarcodeScannerDataReceivedEventData data structure, barcode scanner drivers should create the WDFMEMORY objects
-    // and pass them to PosCx.
-
-    WDF_OBJECT_ATTRIBUTES Attributes;
-    WDF_OBJECT_ATTRIBUTES_INIT(&Attributes);
-    Attributes.ParentObject = Device;
-
-    BYTE* eventData = nullptr;
-    WDFMEMORY eventMemory = NULL;
-    NTSTATUS status = WdfMemoryCreate(
-        &Attributes,
-        NonPagedPoolNx,
-        (ULONG)'eSOP',
-        totalSize,
-        &eventMemory,
-        (PVOID*)&eventData
-        );
-
-    if (!NT_SUCCESS(status))
-    {
-        // handle out of memory error
-        return;
-    }
+    // Since that's the case with the PosBarcodeScannerDataReceivedEventData data structure, barcode scanner drivers build the complete event,
+    // header included, and queue it to the event ring with DataIncludesHeader set.  The ring creates the WDFMEMORY objects when it pends
+    // the queued events to PosCx (see PosEventRing.cpp), so no memory is allocated here while scans are coming in.
+    static_assert(totalSize <= POS_EVENT_RING_SLOT_SIZE, "Barcode event does not fit in an event ring slot");
+    DECLSPEC_ALIGN(8) BYTE eventData[totalSize];
 
     PosBarcodeScannerDataReceivedEventData* eventHeader = (PosBarcodeScannerDataReceivedEventData*)eventData;
     eventHeader->Header.EventType = PosEventType::BarcodeScannerDataReceived;
@@ -86,12 +70,11 @@ VOID EvtOnBarcodeScanDataRetrieved(_In_ WDFDEVICE Device)
     memcpy(eventLabelData, exampleDataLabel, exampleLabelByteCount);
 
 
-    // This call actually pends the data to be send to the WinRT APIs.
-    status = PosCxPutPendingEventMemory(Device, SCANNER_INTERFACE_TAG, eventMemory, POS_CX_EVENT_ATTR_DATA);
+    // This call queues the data to be sent to the WinRT APIs; the ring's work item pends it to PosCx.
+    NTSTATUS status = PosEventRingPut(Device, PosEventType::BarcodeScannerDataReceived, eventData, (ULONG)totalSize, POS_CX_EVENT_ATTR_DATA, TRUE);
 
     if (!NT_SUCCESS(status))
     {
-        // This should only happen in rare cases such as out of memory (or that the device or interface tag isn't found).  The driver should most likely drop the event.
-        WdfObjectDelete(eventMemory);
+        // This should only happen if the ring is full because events are queued faster than they can be pended.  The driver should most likely drop the event.
     }
 }
\ No newline at end of file
@@ -47,7 +47,9 @@ FilterClsid(
 StreamFilter::
 StreamFilter() :
     m_bShutdown(false),
-    m_cRef(1)
+    m_cRef(1),
+    m_cbBuffer(kBufferSize),
+    m_bPassthrough(false)
 {
 }
 
@@ -169,6 +171,35 @@ InitializeFilter(
         m_pIPipelineControl = pIPipelineControl;
     }
 
+    //
+    // The copy can be tuned through optional properties in the property bag.
+    // StreamFilterBufferSize (VT_UI4) sets the size of each copy buffer, and
+    // StreamFilterPassthrough (VT_BOOL) selects a synchronous single-buffer
+    // copy instead of the double-buffered copy.
+    //
+    if (SUCCEEDED(hr))
+    {
+        VARIANT varOption;
+
+        VariantInit(&varOption);
+
+        if (SUCCEEDED(pIPropertyBag->GetProperty(L"StreamFilterBufferSize", &varOption)) &&
+            SUCCEEDED(VariantChangeType(&varOption, &varOption, 0, VT_UI4)))
+        {
+            m_cbBuffer = min(max(V_UI4(&varOption), static_cast<ULONG>(kMinBufferSize)), static_cast<ULONG>(kMaxBufferSize));
+        }
+
+        VariantClear(&varOption);
+
+        if (SUCCEEDED(pIPropertyBag->GetProperty(L"StreamFilterPassthrough", &varOption)) &&
+            SUCCEEDED(VariantChangeType(&varOption, &varOption, 0, VT_BOOL)))
+        {
+            m_bPassthrough = (V_BOOL(&varOption) != VARIANT_FALSE);
+        }
+
+        VariantClear(&varOption);
+    }
+
     //
     // This shows how to use the helper interface to read information
     // from a UnidrvUI based configuration module.
@@ -215,11 +246,71 @@ StartOperation(
 {
     HRESULT                         hr = S_OK;
     Tools::SmartPtr<IImgErrorInfo>  pIErrorInfo;
+    StreamCopyStats                 stats = {0};
+    LARGE_INTEGER                   frequency;
+    LARGE_INTEGER                   start;
+    LARGE_INTEGER                   stop;
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+
+    if (m_bPassthrough)
+    {
+        hr = CopyPassthrough(&stats);
+    }
+    else
+    {
+        hr = CopyDoubleBuffered(&stats);
+    }
+
+    QueryPerformanceCounter(&stop);
+
+    //
+    // Report the throughput of this filter stage. Comparing the total time
+    // with the time spent blocked in reads and writes shows how much of the
+    // pipeline overhead is due to this stage.
+    //
+    ULONGLONG elapsedMs = static_cast<ULONGLONG>(stop.QuadPart - start.QuadPart) * 1000 / frequency.QuadPart;
+    ULONGLONG readMs    = static_cast<ULONGLONG>(stats.readTicks) * 1000 / frequency.QuadPart;
+    ULONGLONG writeMs   = static_cast<ULONGLONG>(stats.writeTicks) * 1000 / frequency.QuadPart;
+    ULONGLONG kbPerSec  = elapsedMs ? (stats.cbCopied * 1000 / 1024) / elapsedMs : 0;
+
+    DoTraceMessage(WS_TRACE, "StreamFilter::StartOperation copied %I64u bytes in %u reads of up to %u bytes, %s", stats.cbCopied, stats.cReads, m_cbBuffer, m_bPassthrough ? "passthrough" : "double buffered");
+    DoTraceMessage(WS_TRACE, "StreamFilter::StartOperation %I64u ms total, %I64u ms reading, %I64u ms writing, %I64u KB/s", elapsedMs, readMs, writeMs, kbPerSec);
+
+    m_pIWrite->Close();
+
+    if (FAILED(hr))
+    {
+        m_pIPipelineControl->RequestShutdown(hr, pIErrorInfo);
+    }
+
+    if (m_pIPipelineControl)
+    {
+        m_pIPipelineControl->FilterFinished();
+    }
+
+    return hr;
+}
+
+//
+// Copies the stream with one buffer, writing each block as soon as it has
+// been read. The data is handed across unchanged.
+//
+HRESULT
+StreamFilter::
+CopyPassthrough(
+    _Inout_ StreamCopyStats     *pStats
+    )
+{
+    HRESULT                         hr = S_OK;
     DWORD                           cbRead;
     BYTE                            *pReadBuf;
     BOOL                            bEof = FALSE;
+    LARGE_INTEGER                   start;
+    LARGE_INTEGER                   stop;
 
-    pReadBuf = new BYTE[kBufferSize];
+    pReadBuf = new BYTE[m_cbBuffer];
 
     if (!pReadBuf)
     {
@@ -228,36 +319,247 @@ StartOperation(
 
     while (SUCCEEDED(hr) && !bEof && !m_bShutdown)
     {
-        hr = m_pIRead->ReadBytes(pReadBuf, kBufferSize, &cbRead, &bEof);
+        QueryPerformanceCounter(&start);
+
+        hr = m_pIRead->ReadBytes(pReadBuf, m_cbBuffer, &cbRead, &bEof);
+
+        QueryPerformanceCounter(&stop);
+
+        pStats->readTicks += stop.QuadPart - start.QuadPart;
 
         if (SUCCEEDED(hr) && cbRead)
         {
             ULONG   cbWritten;
 
+            pStats->cReads++;
+
+            QueryPerformanceCounter(&start);
+
             hr = m_pIWrite->WriteBytes(pReadBuf, cbRead, &cbWritten);
 
+            QueryPerformanceCounter(&stop);
+
+            pStats->writeTicks += stop.QuadPart - start.QuadPart;
+
             if (SUCCEEDED(hr))
             {
+                pStats->cbCopied += cbRead;
+
                 DoTraceMessage(WS_TRACE, "StreamFilter::StartOperation read and wrote %u bytes", cbRead);
             }
         }
     }
 
-    m_pIWrite->Close();
+    delete [] pReadBuf;
 
-    if (FAILED(hr))
+    return hr;
+}
+
+namespace
+{
+
+//
+// State shared between the reader (StartOperation's thread) and the
+// writer thread. The reader fills one buffer while the writer drains the
+// other. The last buffer the reader hands over is marked bLast, whether
+// the copy finished, failed or was shut down, so the writer always exits.
+//
+struct CopyBuffer
+{
+    BYTE                *pData;
+    ULONG               cbData;
+    BOOL                bLast;
+};
+
+struct DoubleBufferedCopy
+{
+    IPrintWriteStream   *pIWrite;
+    CopyBuffer          buffers[2];
+    HANDLE              hEmpty;         // buffers the reader may fill
+    HANDLE              hFull;          // buffers the writer may drain
+    HRESULT             hrWrite;
+    LONGLONG            writeTicks;
+};
+
+}
+
+DWORD
+WINAPI
+StreamFilter::
+WriterThread(
+    _In_    LPVOID              pContext
+    )
+{
+    DoubleBufferedCopy  *pCopy = static_cast<DoubleBufferedCopy *>(pContext);
+    HRESULT             hrCom = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+    UINT                i = 0;
+    BOOL                bLast = FALSE;
+    LARGE_INTEGER       start;
+    LARGE_INTEGER       stop;
+
+    while (!bLast)
     {
-        m_pIPipelineControl->RequestShutdown(hr, pIErrorInfo);
+        WaitForSingleObject(pCopy->hFull, INFINITE);
+
+        CopyBuffer *pBuffer = &pCopy->buffers[i];
+
+        bLast = pBuffer->bLast;
+
+        //
+        // After a write fails keep draining the buffers, without writing
+        // them, until the reader hands over the last one
+        //
+        if (SUCCEEDED(pCopy->hrWrite) && pBuffer->cbData)
+        {
+            ULONG   cbWritten;
+
+            QueryPerformanceCounter(&start);
+
+            pCopy->hrWrite = pCopy->pIWrite->WriteBytes(pBuffer->pData, pBuffer->cbData, &cbWritten);
+
+            QueryPerformanceCounter(&stop);
+
+            pCopy->writeTicks += stop.QuadPart - start.QuadPart;
+        }
+
+        ReleaseSemaphore(pCopy->hEmpty, 1, NULL);
+
+        i ^= 1;
     }
 
-    if (m_pIPipelineControl)
+    if (SUCCEEDED(hrCom))
     {
-        m_pIPipelineControl->FilterFinished();
+        CoUninitialize();
     }
 
-    delete [] pReadBuf;
+    return 0;
+}
+
+//
+// Copies the stream with two buffers, so that the next block is read while
+// the previous one is being written on a second thread.
+//
+HRESULT
+StreamFilter::
+CopyDoubleBuffered(
+    _Inout_ StreamCopyStats     *pStats
+    )
+{
+    HRESULT                         hr = S_OK;
+    DoubleBufferedCopy              copy;
+    HANDLE                          hWriter = NULL;
+    LARGE_INTEGER                   start;
+    LARGE_INTEGER                   stop;
+
+    ZeroMemory(&copy, sizeof(copy));
+
+    copy.pIWrite = m_pIWrite;
+    copy.hrWrite = S_OK;
+
+    for (UINT i = 0; SUCCEEDED(hr) && i < ARRAYSIZE(copy.buffers); i++)
+    {
+        copy.buffers[i].pData = new BYTE[m_cbBuffer];
+
+        if (!copy.buffers[i].pData)
+        {
+            hr = E_OUTOFMEMORY;
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        copy.hEmpty = CreateSemaphore(NULL, ARRAYSIZE(copy.buffers), ARRAYSIZE(copy.buffers), NULL);
+        copy.hFull  = CreateSemaphore(NULL, 0, ARRAYSIZE(copy.buffers), NULL);
+
+        if (!copy.hEmpty || !copy.hFull)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hWriter = CreateThread(NULL, 0, WriterThread, &copy, 0, NULL);
+
+        if (!hWriter)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        UINT    i = 0;
+        BOOL    bEof = FALSE;
+        BOOL    bLast = FALSE;
+
+        while (!bLast)
+        {
+            WaitForSingleObject(copy.hEmpty, INFINITE);
+
+            CopyBuffer *pBuffer = &copy.buffers[i];
+
+            pBuffer->cbData = 0;
+
+            if (SUCCEEDED(hr) && SUCCEEDED(copy.hrWrite) && !m_bShutdown)
+            {
+                DWORD   cbRead = 0;
+
+                QueryPerformanceCounter(&start);
+
+                hr = m_pIRead->ReadBytes(pBuffer->pData, m_cbBuffer, &cbRead, &bEof);
+
+                QueryPerformanceCounter(&stop);
+
+                pStats->readTicks += stop.QuadPart - start.QuadPart;
+
+                if (SUCCEEDED(hr) && cbRead)
+                {
+                    pBuffer->cbData = cbRead;
+                    pStats->cbCopied += cbRead;
+                    pStats->cReads++;
+                }
+            }
+
+            bLast = bEof || FAILED(hr) || FAILED(copy.hrWrite) || m_bShutdown;
+
+            pBuffer->bLast = bLast;
+
+            ReleaseSemaphore(copy.hFull, 1, NULL);
+
+            i ^= 1;
+        }
+
+        WaitForSingleObject(hWriter, INFINITE);
+
+        pStats->writeTicks = copy.writeTicks;
+
+        if (SUCCEEDED(hr))
+        {
+            hr = copy.hrWrite;
+        }
+    }
+
+    if (hWriter)
+    {
+        CloseHandle(hWriter);
+    }
+
+    if (copy.hEmpty)
+    {
+        CloseHandle(copy.hEmpty);
+    }
+
+    if (copy.hFull)
+    {
+        CloseHandle(copy.hFull);
+    }
+
+    for (UINT i = 0; i < ARRAYSIZE(copy.buffers); i++)
+    {
+        delete [] copy.buffers[i].pData;
+    }
 
     return hr;
 }
 
-
@@ -19,6 +19,18 @@
 #ifndef _STREAM_FILTER_SAMPLE_HXX_
 #define _STREAM_FILTER_SAMPLE_HXX_
 
+//
+// Throughput of one stream copy, traced when the copy finishes.
+// Times are in QueryPerformanceCounter ticks.
+//
+struct StreamCopyStats
+{
+    ULONGLONG   cbCopied;
+    ULONG       cReads;
+    LONGLONG    readTicks;
+    LONGLONG    writeTicks;
+};
+
 class StreamFilter :
     public  IPrintPipelineFilter,
     private DllLockManager
@@ -83,17 +95,38 @@ public:
 
 private:
 
+    HRESULT
+    CopyPassthrough(
+        _Inout_ StreamCopyStats     *pStats
+        );
+
+    HRESULT
+    CopyDoubleBuffered(
+        _Inout_ StreamCopyStats     *pStats
+        );
+
+    static
+    DWORD
+    WINAPI
+    WriterThread(
+        _In_    LPVOID              pContext
+        );
+
     enum
     {
-        kBufferSize     = 0x10000
+        kBufferSize     = 0x10000,
+        kMinBufferSize  = 0x1000,
+        kMaxBufferSize  = 0x1000000
     };
 
     Tools::SmartPtr<IPrintReadStream>                m_pIRead;
     Tools::SmartPtr<IPrintWriteStream>               m_pIWrite;
     Tools::SmartPtr<IPrintPipelineManagerControl>    m_pIPipelineControl;
     Tools::SmartPtr<IPrintPipelineProgressReport>    m_pProgressReport;
-    bool                                             m_bShutdown;
+    volatile bool                                    m_bShutdown;
     LONG                                             m_cRef;
+    ULONG                                            m_cbBuffer;
+    bool                                             m_bPassthrough;
 };
 
 #endif // _STREAM_FILTER_SAMPLE_HXX_
@@ -380,30 +380,21 @@ CBookletFilter::FlushCache(
             try
             {
                 //
-                // Re-order pages in the cache
+                // Write out the pages in booklet order. The first half of the
+                // document goes to the even output positions in order and the
+                // second half to the odd positions in reverse, so the cached
+                // page for each output position can be found directly rather
+                // than building a re-ordered copy of the cache. Each page is
+                // released as soon as it has been sent so the pipeline can free
+                // it while the rest of the booklet is still being written.
                 //
-                map<size_t, IFixedPage*>  reorderedPages;
-                size_t newIndex = 0;
-                size_t pageIndex = 0;
-                for (pageIndex = 0; pageIndex < cPages/2; pageIndex++)
+                for (size_t outIndex = 0; outIndex < cPages && SUCCEEDED(hr); outIndex++)
                 {
-                    reorderedPages[newIndex] = m_cacheFP[pageIndex];
-                    newIndex += 2;
-                }
+                    size_t pageIndex = (outIndex % 2 == 0) ? (outIndex / 2) : (cPages / 2 + (cPages - 1 - outIndex) / 2);
 
-                newIndex = cPages - 1;
-                for (pageIndex = cPages/2; pageIndex < cPages; pageIndex++)
-                {
-                    reorderedPages[newIndex] = m_cacheFP[pageIndex];
-                    newIndex -= 2;
-                }
+                    hr = m_pXDWriter->SendFixedPage(m_cacheFP[pageIndex]);
 
-                //
-                // Write out reordered pages
-                //
-                for (pageIndex = 0; pageIndex < cPages && SUCCEEDED(hr); pageIndex++)
-                {
-                    hr = m_pXDWriter->SendFixedPage(reorderedPages[pageIndex]);
+                    m_cacheFP[pageIndex] = NULL;
                 }
 
                 //
@@ -24,6 +24,7 @@ Abstract:
 
 #include "xdrchflt.h"
 #include "ptmanage.h"
+#include "transform.h"
 
 typedef map<CStringXDW, BOOL> ResDeleteMap;
 
@@ -47,5 +48,11 @@ private:
     // color profiles in the container
     //
     CFileResourceCache m_resCache;
+
+    //
+    // Cache of color transforms kept across pages so that the transforms for recurring
+    // source profiles are only created once per job
+    //
+    CTransform         m_colorTrans;
 };
 
@@ -20,6 +20,9 @@ Abstract:
    the IResWriter interface so that the font can be added to the resource
    cache.
 
+   This file also contains a utility class that splits the translation of wide
+   scanlines across worker threads.
+
 --*/
 
 #include "precomp.h"
@@ -34,6 +37,454 @@ using XDPrintSchema::PageSourceColorProfile::EProfileOption;
 using XDPrintSchema::PageSourceColorProfile::RGB;
 using XDPrintSchema::PageSourceColorProfile::CMYK;
 
+//
+// The minimum count of pixels translated by one thread. Narrower scanlines are not
+// worth the cost of handing them to a worker thread.
+//
+static CONST UINT kMinPixelsPerSegment = 512;
+
+class CScanLineTranslator
+{
+public:
+    /*++
+
+    Routine Name:
+
+        CScanLineTranslator
+
+    Routine Description:
+
+        CScanLineTranslator constructor
+
+    Arguments:
+
+        phTrans - Pointer to an array of equivalent transform handles, one per thread
+        cTrans  - Count of handles in the array
+
+    Return Value:
+
+        None
+        Throws an exception on error.
+
+    --*/
+    CScanLineTranslator(
+        _In_reads_(cTrans) HTRANSFORM* phTrans,
+        _In_               UINT        cTrans
+        ) :
+        m_cTrans(0),
+        m_cSegments(0),
+        m_cPending(0),
+        m_hDone(NULL)
+    {
+        HRESULT hr = S_OK;
+
+        if (SUCCEEDED(hr = CHECK_POINTER(phTrans, E_POINTER)))
+        {
+            if (cTrans == 0 ||
+                cTrans > kMaxTransformsPerEntry)
+            {
+                hr = E_INVALIDARG;
+            }
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            ZeroMemory(m_segments, sizeof(m_segments));
+
+            for (UINT cSegment = 0; cSegment < cTrans; cSegment++)
+            {
+                m_segments[cSegment].hTrans = phTrans[cSegment];
+                m_segments[cSegment].pTranslator = this;
+            }
+
+            m_cTrans = cTrans;
+
+            //
+            // Without an event to wait on the scanlines are simply translated on the calling thread
+            //
+            if (m_cTrans > 1)
+            {
+                m_hDone = CreateEvent(NULL, TRUE, FALSE, NULL);
+            }
+        }
+
+        if (FAILED(hr))
+        {
+            throw CXDException(hr);
+        }
+    }
+
+    /*++
+
+    Routine Name:
+
+        ~CScanLineTranslator
+
+    Routine Description:
+
+        CScanLineTranslator destructor
+
+    Arguments:
+
+        None
+
+    Return Value:
+
+        None
+
+    --*/
+    ~CScanLineTranslator()
+    {
+        if (m_hDone != NULL)
+        {
+            CloseHandle(m_hDone);
+            m_hDone = NULL;
+        }
+    }
+
+    /*++
+
+    Routine Name:
+
+        Translate
+
+    Routine Description:
+
+        Translates a block of scanline data. Scanlines wide enough to be worth splitting
+        are divided into segments of whole pixels, each translated on its own thread
+        with its own transform handle. The calling thread translates the first segment
+        and returns once all segments are complete. If a LUT is supplied, the segments
+        are translated by interpolating the LUT instead of calling ICM/WCS.
+
+    Arguments:
+
+        pSrcData    - Pointer to the source scanline data
+        bmSrcFormat - Format of the source data
+        cWidth      - Width of the scanlines in pixels
+        cHeight     - Count of scanlines
+        cbSrcStride - Stride of the source data
+        pDstData    - Pointer to the destination scanline data
+        bmDstFormat - Format of the destination data
+        cbDstStride - Stride of the destination data
+        pLUT        - Optional pointer to a LUT sampled from the transform for these formats
+
+    Return Value:
+
+        HRESULT
+        S_OK - On success
+        E_*  - On error
+
+    --*/
+    HRESULT
+    Translate(
+        _In_     PBYTE      pSrcData,
+        _In_     BMFORMAT   bmSrcFormat,
+        _In_     UINT       cWidth,
+        _In_     UINT       cHeight,
+        _In_     UINT       cbSrcStride,
+        _In_     PBYTE      pDstData,
+        _In_     BMFORMAT   bmDstFormat,
+        _In_     UINT       cbDstStride,
+        _In_opt_ CColorLUT* pLUT
+        )
+    {
+        HRESULT hr = S_OK;
+
+        if (SUCCEEDED(hr = CHECK_POINTER(pSrcData, E_POINTER)) &&
+            SUCCEEDED(hr = CHECK_POINTER(pDstData, E_POINTER)))
+        {
+            UINT cbSrcPixel = GetBytesPerPixel(bmSrcFormat);
+            UINT cbDstPixel = GetBytesPerPixel(bmDstFormat);
+
+            m_cSegments = 1;
+
+            if (m_hDone != NULL &&
+                cbSrcPixel > 0 &&
+                cbDstPixel > 0)
+            {
+                m_cSegments = min(cWidth / kMinPixelsPerSegment, m_cTrans);
+                if (m_cSegments == 0)
+                {
+                    m_cSegments = 1;
+                }
+            }
+
+            UINT cSegmentWidth = cWidth / m_cSegments;
+
+            for (UINT cSegment = 0; cSegment < m_cSegments; cSegment++)
+            {
+                Segment* pSegment = &m_segments[cSegment];
+                UINT     cOffset  = cSegment * cSegmentWidth;
+
+                pSegment->pSrcData    = pSrcData + cOffset * cbSrcPixel;
+                pSegment->bmSrcFormat = bmSrcFormat;
+                pSegment->cWidth      = (cSegment == m_cSegments - 1) ? cWidth - cOffset : cSegmentWidth;
+                pSegment->cHeight     = cHeight;
+                pSegment->cbSrcStride = cbSrcStride;
+                pSegment->pDstData    = pDstData + cOffset * cbDstPixel;
+                pSegment->bmDstFormat = bmDstFormat;
+                pSegment->cbDstStride = cbDstStride;
+                pSegment->pLUT        = pLUT;
+                pSegment->hr          = S_OK;
+            }
+
+            if (m_cSegments > 1)
+            {
+                ResetEvent(m_hDone);
+                m_cPending = static_cast<LONG>(m_cSegments - 1);
+
+                for (UINT cSegment = 1; cSegment < m_cSegments; cSegment++)
+                {
+                    if (!QueueUserWorkItem(SegmentWorker, &m_segments[cSegment], WT_EXECUTEDEFAULT))
+                    {
+                        //
+                        // Translate the segment on this thread instead
+                        //
+                        SegmentWorker(&m_segments[cSegment]);
+                    }
+                }
+            }
+
+            TranslateSegment(&m_segments[0]);
+
+            if (m_cSegments > 1)
+            {
+                WaitForSingleObject(m_hDone, INFINITE);
+            }
+
+            for (UINT cSegment = 0; SUCCEEDED(hr) && cSegment < m_cSegments; cSegment++)
+            {
+                hr = m_segments[cSegment].hr;
+            }
+        }
+
+        ERR_ON_HR(hr);
+        return hr;
+    }
+
+private:
+    struct Segment
+    {
+        CScanLineTranslator* pTranslator;
+
+        HTRANSFORM           hTrans;
+
+        PBYTE                pSrcData;
+
+        BMFORMAT             bmSrcFormat;
+
+        UINT                 cWidth;
+
+        UINT                 cHeight;
+
+        UINT                 cbSrcStride;
+
+        PBYTE                pDstData;
+
+        BMFORMAT             bmDstFormat;
+
+        UINT                 cbDstStride;
+
+        CColorLUT*           pLUT;
+
+        HRESULT              hr;
+    };
+
+    /*++
+
+    Routine Name:
+
+        TranslateSegment
+
+    Routine Description:
+
+        Translates one segment of the scanline data and records any error
+
+    Arguments:
+
+        pSegment - Pointer to the segment to translate
+
+    Return Value:
+
+        None
+
+    --*/
+    static VOID
+    TranslateSegment(
+        _Inout_ Segment* pSegment
+        )
+    {
+        if (pSegment->pLUT != NULL)
+        {
+            pSegment->hr = pSegment->pLUT->Apply(pSegment->pSrcData,
+                                                 pSegment->cWidth,
+                                                 pSegment->cHeight,
+                                                 pSegment->cbSrcStride,
+                                                 pSegment->pDstData,
+                                                 pSegment->cbDstStride);
+        }
+        else if (!TranslateBitmapBits(pSegment->hTrans,
+                                 pSegment->pSrcData,
+                                 pSegment->bmSrcFormat,
+                                 pSegment->cWidth,
+                                 pSegment->cHeight,
+                                 pSegment->cbSrcStride,
+                                 pSegment->pDstData,
+                                 pSegment->bmDstFormat,
+                                 pSegment->cbDstStride,
+                                 NULL,
+                                 0))
+        {
+            RIP("Translate bitmap bits failed.\n");
+
+            pSegment->hr = GetLastErrorAsHResult();
+        }
+    }
+
+    /*++
+
+    Routine Name:
+
+        SegmentWorker
+
+    Routine Description:
+
+        Thread pool callback that translates a segment and signals the waiting
+        thread once the last outstanding segment is complete
+
+    Arguments:
+
+        pContext - Pointer to the segment to translate
+
+    Return Value:
+
+        DWORD
+        Always 0
+
+    --*/
+    static DWORD WINAPI
+    SegmentWorker(
+        _In_ LPVOID pContext
+        )
+    {
+        Segment*             pSegment    = static_cast<Segment*>(pContext);
+        CScanLineTranslator* pTranslator = pSegment->pTranslator;
+
+        TranslateSegment(pSegment);
+
+        if (InterlockedDecrement(&pTranslator->m_cPending) == 0)
+        {
+            SetEvent(pTranslator->m_hDone);
+        }
+
+        return 0;
+    }
+
+    /*++
+
+    Routine Name:
+
+        GetBytesPerPixel
+
+    Routine Description:
+
+        Retrieves the size of a pixel for the BMFORMATs that can be split on pixel
+        boundaries
+
+    Arguments:
+
+        bmFormat - The BMFORMAT to look up
+
+    Return Value:
+
+        UINT
+        The count of bytes per pixel, or 0 if the format should not be split
+
+    --*/
+    static UINT
+    GetBytesPerPixel(
+        _In_ BMFORMAT bmFormat
+        )
+    {
+        UINT cbPixel = 0;
+
+        switch (bmFormat)
+        {
+            case BM_GRAY:
+            {
+                cbPixel = 1;
+            }
+            break;
+
+            case BM_16b_GRAY:
+            {
+                cbPixel = 2;
+            }
+            break;
+
+            case BM_RGBTRIPLETS:
+            case BM_BGRTRIPLETS:
+            {
+                cbPixel = 3;
+            }
+            break;
+
+            case BM_xRGBQUADS:
+            case BM_xBGRQUADS:
+            case BM_CMYKQUADS:
+            case BM_KYMCQUADS:
+            {
+                cbPixel = 4;
+            }
+            break;
+
+            case BM_16b_RGB:
+            case BM_S2DOT13FIXED_scRGB:
+            {
+                cbPixel = 6;
+            }
+            break;
+
+            case BM_S2DOT13FIXED_scARGB:
+            {
+                cbPixel = 8;
+            }
+            break;
+
+            case BM_32b_scRGB:
+            {
+                cbPixel = 12;
+            }
+            break;
+
+            case BM_32b_scARGB:
+            {
+                cbPixel = 16;
+            }
+            break;
+
+            default:
+            {
+                cbPixel = 0;
+            }
+            break;
+        }
+
+        return cbPixel;
+    }
+
+private:
+    Segment       m_segments[kMaxTransformsPerEntry];
+
+    UINT          m_cTrans;
+
+    UINT          m_cSegments;
+
+    volatile LONG m_cPending;
+
+    HANDLE        m_hDone;
+};
+
 /*++
 
 Routine Name:
@@ -400,12 +851,7 @@ CColorManagedImage::WriteData(
                 //
                 if (SUCCEEDED(hr))
                 {
-                    (*m_pResDel)[m_bstrBitmapURI.m_str] = TRUE;
-
-                    if (m_bstrSrcProfileURI.Length() > 0)
-                    {
-                        (*m_pResDel)[m_bstrSrcProfileURI.m_str] = TRUE;
-                    }
+                    MarkSourceForDeletion();
                 }
             }
         }
@@ -486,6 +932,106 @@ CColorManagedImage::GetKeyName(
 
 /*++
 
+Routine Name:
+
+    CColorManagedImage::GetContentKey
+
+Routine Description:
+
+    Method to obtain a key identifying the converted bitmap by content. The key
+    hashes the source bitmap data, the data of any associated source profile and
+    the destination profile, so bitmaps stored under different names in the
+    container share a single converted part.
+
+Arguments:
+
+    pbstrContentKey - Pointer to a string to hold the generated key
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CColorManagedImage::GetContentKey(
+    _Outptr_result_maybenull_ BSTR* pbstrContentKey
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(pbstrContentKey, E_POINTER)))
+    {
+        *pbstrContentKey = NULL;
+
+        try
+        {
+            CContentHash hash;
+            CComBSTR     bstrDstProfile;
+
+            if (SUCCEEDED(hr = hash.HashPart(m_pFixedPage, m_bstrBitmapURI)) &&
+                (m_bstrSrcProfileURI.Length() == 0 ||
+                 SUCCEEDED(hr = hash.HashPart(m_pFixedPage, m_bstrSrcProfileURI))) &&
+                SUCCEEDED(hr = m_pProfManager->GetDstProfileName(&bstrDstProfile)) &&
+                SUCCEEDED(hr = hash.HashString(bstrDstProfile.Length() > 0 ? bstrDstProfile.m_str : L"")))
+            {
+                hr = hash.GetKey(pbstrContentKey);
+            }
+        }
+        catch (CXDException& e)
+        {
+            hr = e;
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CColorManagedImage::MarkSourceForDeletion
+
+Routine Description:
+
+    Marks the source bitmap and any associated source profile for deletion from
+    the fixed page once it has been replaced by a converted bitmap. This is required
+    whether the converted bitmap is written or shared from the resource cache.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+VOID
+CColorManagedImage::MarkSourceForDeletion(
+    VOID
+    )
+{
+    try
+    {
+        (*m_pResDel)[m_bstrBitmapURI.m_str] = TRUE;
+
+        if (m_bstrSrcProfileURI.Length() > 0)
+        {
+            (*m_pResDel)[m_bstrSrcProfileURI.m_str] = TRUE;
+        }
+    }
+    catch (exception& DBG_ONLY(e))
+    {
+        ERR(e.what());
+    }
+}
+
+/*++
+
 Routine Name:
 
     CColorManagedImage::GetResURI
@@ -783,11 +1329,14 @@ CColorManagedImage::TransformScanLines(
             //
             // Apply the transform
             //
-            HTRANSFORM hTransform = NULL;
-            BOOL       bCanUseWCS = FALSE;
+            HTRANSFORM* phTransforms = NULL;
+            UINT        cTransforms = 0;
+            BOOL        bCanUseWCS = FALSE;
 
-            if (SUCCEEDED(hr = m_pProfManager->GetColorTransform(&hTransform, &bCanUseWCS)))
+            if (SUCCEEDED(hr = m_pProfManager->GetColorTransforms(&phTransforms, &cTransforms, &bCanUseWCS)))
             {
+                CScanLineTranslator translator(phTransforms, cTransforms);
+
                 PBYTE    pDstData = NULL;
                 BMFORMAT bmSrcFormat;
                 UINT     cSrcWidth = 0;
@@ -814,19 +1363,20 @@ CColorManagedImage::TransformScanLines(
                         SUCCEEDED(hr = pDstScans->GetScanBuffer(&pDstData, &bmDstFormat, &cDstWidth, &cDstHeight, &cbDstStride)))
                     {
                         //
-                        // ...translate the scanline data...
+                        // ...translate the scanline data, through a LUT where the transform has one...
                         //
-                        if (TranslateBitmapBits(hTransform,
-                                                pSrcData,
-                                                bmSrcFormat,
-                                                cSrcWidth,
-                                                cSrcHeight,
-                                                cbSrcStride,
-                                                pDstData,
-                                                bmDstFormat,
-                                                cbDstStride,
-                                                NULL,
-                                                0))
+                        CColorLUT* pLUT = NULL;
+
+                        if (SUCCEEDED(hr = m_pProfManager->GetColorLUT(bmSrcFormat, bmDstFormat, cSrcWidth * cSrcHeight, &pLUT)) &&
+                            SUCCEEDED(hr = translator.Translate(pSrcData,
+                                                                bmSrcFormat,
+                                                                cSrcWidth,
+                                                                cSrcHeight,
+                                                                cbSrcStride,
+                                                                pDstData,
+                                                                bmDstFormat,
+                                                                cbDstStride,
+                                                                pLUT)))
                         {
                             //
                             // ...and commit the data to the destination bitmap before incrementing to the next scanline.
@@ -835,11 +1385,6 @@ CColorManagedImage::TransformScanLines(
                             (*pSrcScans)++;
                             (*pDstScans)++;
                         }
-                        else
-                        {
-                            RIP("Translate bitmap bits failed.\n");
-                            hr = GetLastErrorAsHResult();
-                        }
                     }
                 }
             }
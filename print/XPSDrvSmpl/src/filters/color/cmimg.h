@@ -57,6 +57,16 @@ public:
         _Outptr_ BSTR* pbstrResURI
         );
 
+    HRESULT
+    GetContentKey(
+        _Outptr_result_maybenull_ BSTR* pbstrContentKey
+        );
+
+    VOID
+    MarkSourceForDeletion(
+        VOID
+        );
+
 private:
     HRESULT
     SetSrcProfile(
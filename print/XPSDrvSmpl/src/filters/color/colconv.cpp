@@ -230,6 +230,15 @@ CBitmapColorConverter::Convert(
                 hr = m_pResCache->GetURI(bstrKey, pbstrBmpURI);
 
                 ASSERTMSG(SUCCEEDED(hr), "Failed to process image");
+
+                //
+                // The converted bitmap may have been shared from an earlier page or
+                // resource; either way the original is no longer referenced
+                //
+                if (SUCCEEDED(hr))
+                {
+                    bmpColManaged.MarkSourceForDeletion();
+                }
             }
         }
         catch (CXDException& e)
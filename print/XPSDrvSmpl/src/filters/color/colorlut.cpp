@@ -0,0 +1,526 @@
+/*++
+
+Copyright (c) 2005 Microsoft Corporation
+
+All rights reserved.
+
+THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+PARTICULAR PURPOSE.
+
+File Name:
+
+   colorlut.cpp
+
+Abstract:
+
+   CColorLUT class implementation. This class samples a color transform on a regular 3D grid
+   of 8 bit per channel source colors and applies the transform to bitmap data by
+   tetrahedral interpolation between the grid nodes.
+
+--*/
+
+#include "precomp.h"
+#include "debug.h"
+#include "globals.h"
+#include "colorlut.h"
+
+/*++
+
+Routine Name:
+
+    CColorLUT::CColorLUT
+
+Routine Description:
+
+    CColorLUT constructor
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+CColorLUT::CColorLUT() :
+    m_bmSrcFormat(BM_RGBTRIPLETS),
+    m_bmDstFormat(BM_RGBTRIPLETS),
+    m_cbSrcPixel(0),
+    m_cbDstPixel(0),
+    m_pNodes(NULL)
+{
+}
+
+/*++
+
+Routine Name:
+
+    CColorLUT::~CColorLUT
+
+Routine Description:
+
+    CColorLUT destructor
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+CColorLUT::~CColorLUT()
+{
+    FreeNodes();
+}
+
+/*++
+
+Routine Name:
+
+    CColorLUT::Create
+
+Routine Description:
+
+    Builds the LUT by translating a grid of source colors through the transform
+
+Arguments:
+
+    hTrans      - Handle to the transform to sample
+    bmSrcFormat - Format of the source data the LUT is applied to
+    bmDstFormat - Format of the destination data the LUT generates
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CColorLUT::Create(
+    _In_ HTRANSFORM     hTrans,
+    _In_ CONST BMFORMAT bmSrcFormat,
+    _In_ CONST BMFORMAT bmDstFormat
+    )
+{
+    HRESULT hr = S_OK;
+
+    FreeNodes();
+
+    if (SUCCEEDED(hr = CHECK_HANDLE(hTrans, E_HANDLE)))
+    {
+        if (!IsSupported(bmSrcFormat, bmDstFormat))
+        {
+            hr = E_INVALIDARG;
+        }
+    }
+
+    PBYTE pGrid = NULL;
+
+    if (SUCCEEDED(hr))
+    {
+        m_bmSrcFormat = bmSrcFormat;
+        m_bmDstFormat = bmDstFormat;
+        m_cbSrcPixel = GetSrcBytesPerPixel(bmSrcFormat);
+        m_cbDstPixel = GetDstBytesPerPixel(bmDstFormat);
+
+        pGrid = new(std::nothrow) BYTE[kLUTNodeCount * m_cbSrcPixel];
+        m_pNodes = new(std::nothrow) BYTE[kLUTNodeCount * m_cbDstPixel];
+
+        if (SUCCEEDED(hr = CHECK_POINTER(pGrid, E_OUTOFMEMORY)) &&
+            SUCCEEDED(hr = CHECK_POINTER(m_pNodes, E_OUTOFMEMORY)))
+        {
+            ZeroMemory(pGrid, kLUTNodeCount * m_cbSrcPixel);
+
+            //
+            // Populate the grid with the source colors at each node. The first channel in the
+            // pixel varies slowest so that the node index follows the channel order.
+            //
+            PBYTE pNode = pGrid;
+            for (UINT i = 0; i < kLUTGridPoints; i++)
+            {
+                for (UINT j = 0; j < kLUTGridPoints; j++)
+                {
+                    for (UINT k = 0; k < kLUTGridPoints; k++, pNode += m_cbSrcPixel)
+                    {
+                        pNode[0] = static_cast<BYTE>((i * 255 + (kLUTGridPoints - 1) / 2) / (kLUTGridPoints - 1));
+                        pNode[1] = static_cast<BYTE>((j * 255 + (kLUTGridPoints - 1) / 2) / (kLUTGridPoints - 1));
+                        pNode[2] = static_cast<BYTE>((k * 255 + (kLUTGridPoints - 1) / 2) / (kLUTGridPoints - 1));
+                    }
+                }
+            }
+
+            //
+            // Translate the whole grid as a single scanline
+            //
+            if (!TranslateBitmapBits(hTrans,
+                                     pGrid,
+                                     m_bmSrcFormat,
+                                     kLUTNodeCount,
+                                     1,
+                                     0,
+                                     m_pNodes,
+                                     m_bmDstFormat,
+                                     0,
+                                     NULL,
+                                     0))
+            {
+                hr = GetLastErrorAsHResult();
+            }
+        }
+    }
+
+    if (pGrid != NULL)
+    {
+        delete[] pGrid;
+        pGrid = NULL;
+    }
+
+    if (FAILED(hr))
+    {
+        FreeNodes();
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CColorLUT::Matches
+
+Routine Description:
+
+    Reports whether the LUT was built for the source and destination formats
+
+Arguments:
+
+    bmSrcFormat - Format of the source data
+    bmDstFormat - Format of the destination data
+
+Return Value:
+
+    BOOL
+    TRUE  - The LUT has been built for the formats
+    FALSE - Otherwise
+
+--*/
+BOOL
+CColorLUT::Matches(
+    _In_ CONST BMFORMAT bmSrcFormat,
+    _In_ CONST BMFORMAT bmDstFormat
+    ) CONST
+{
+    return m_pNodes != NULL &&
+           m_bmSrcFormat == bmSrcFormat &&
+           m_bmDstFormat == bmDstFormat;
+}
+
+/*++
+
+Routine Name:
+
+    CColorLUT::Apply
+
+Routine Description:
+
+    Applies the LUT to bitmap data. Each pixel is located in a cell of the grid and
+    interpolated between the four nodes of the tetrahedron within the cell that
+    contains it. The LUT is not modified so it may be applied by several threads
+    at once.
+
+Arguments:
+
+    pSrcData    - Pointer to the source data
+    cWidth      - Width of the data in pixels
+    cHeight     - Count of scanlines
+    cbSrcStride - Stride of the source data
+    pDstData    - Pointer to the destination data
+    cbDstStride - Stride of the destination data
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CColorLUT::Apply(
+    _In_reads_bytes_(cbSrcStride * cHeight)  PBYTE pSrcData,
+    _In_                                     UINT  cWidth,
+    _In_                                     UINT  cHeight,
+    _In_                                     UINT  cbSrcStride,
+    _Out_writes_bytes_(cbDstStride * cHeight) PBYTE pDstData,
+    _In_                                     UINT  cbDstStride
+    ) CONST
+{
+    HRESULT hr = S_OK;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(pSrcData, E_POINTER)) &&
+        SUCCEEDED(hr = CHECK_POINTER(pDstData, E_POINTER)) &&
+        SUCCEEDED(hr = CHECK_POINTER(m_pNodes, E_PENDING)))
+    {
+        CONST UINT cbStepK = m_cbDstPixel;
+        CONST UINT cbStepJ = cbStepK * kLUTGridPoints;
+        CONST UINT cbStepI = cbStepJ * kLUTGridPoints;
+
+        for (UINT cRow = 0; cRow < cHeight; cRow++)
+        {
+            PBYTE pSrc = pSrcData + cRow * cbSrcStride;
+            PBYTE pDst = pDstData + cRow * cbDstStride;
+
+            for (UINT cPixel = 0; cPixel < cWidth; cPixel++, pSrc += m_cbSrcPixel, pDst += m_cbDstPixel)
+            {
+                //
+                // Find the grid cell and the position within the cell (0 - 255) along each axis
+                //
+                UINT index[3];
+                UINT frac[3];
+                UINT step[3] = {cbStepI, cbStepJ, cbStepK};
+
+                for (UINT cAxis = 0; cAxis < 3; cAxis++)
+                {
+                    UINT pos = pSrc[cAxis] * (kLUTGridPoints - 1);
+
+                    index[cAxis] = pos / 255;
+                    frac[cAxis]  = pos - index[cAxis] * 255;
+
+                    if (index[cAxis] == kLUTGridPoints - 1)
+                    {
+                        index[cAxis]--;
+                        frac[cAxis] = 255;
+                    }
+                }
+
+                //
+                // Order the axes by decreasing position. The tetrahedron containing the pixel
+                // runs from the cell origin to the opposite corner stepping along the axes
+                // in that order.
+                //
+                UINT order[3] = {0, 1, 2};
+
+                if (frac[order[0]] < frac[order[1]])
+                {
+                    UINT tmp = order[0]; order[0] = order[1]; order[1] = tmp;
+                }
+
+                if (frac[order[1]] < frac[order[2]])
+                {
+                    UINT tmp = order[1]; order[1] = order[2]; order[2] = tmp;
+                }
+
+                if (frac[order[0]] < frac[order[1]])
+                {
+                    UINT tmp = order[0]; order[0] = order[1]; order[1] = tmp;
+                }
+
+                CONST BYTE* pNode0 = m_pNodes + index[0] * cbStepI + index[1] * cbStepJ + index[2] * cbStepK;
+                CONST BYTE* pNode1 = pNode0 + step[order[0]];
+                CONST BYTE* pNode2 = pNode1 + step[order[1]];
+                CONST BYTE* pNode3 = pNode2 + step[order[2]];
+
+                UINT weight0 = 255 - frac[order[0]];
+                UINT weight1 = frac[order[0]] - frac[order[1]];
+                UINT weight2 = frac[order[1]] - frac[order[2]];
+                UINT weight3 = frac[order[2]];
+
+                //
+                // The weights sum to 255, so divide with rounding to recover the channel value
+                //
+                for (UINT cChannel = 0; cChannel < m_cbDstPixel; cChannel++)
+                {
+                    pDst[cChannel] = static_cast<BYTE>((weight0 * pNode0[cChannel] +
+                                                        weight1 * pNode1[cChannel] +
+                                                        weight2 * pNode2[cChannel] +
+                                                        weight3 * pNode3[cChannel] + 127) / 255);
+                }
+            }
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CColorLUT::IsSupported
+
+Routine Description:
+
+    Reports whether a LUT can be built for the source and destination formats. Only 8 bit
+    per channel formats with three source color channels are supported.
+
+Arguments:
+
+    bmSrcFormat - Format of the source data
+    bmDstFormat - Format of the destination data
+
+Return Value:
+
+    BOOL
+    TRUE  - A LUT can be built for the formats
+    FALSE - Otherwise
+
+--*/
+BOOL
+CColorLUT::IsSupported(
+    _In_ CONST BMFORMAT bmSrcFormat,
+    _In_ CONST BMFORMAT bmDstFormat
+    )
+{
+    return GetSrcBytesPerPixel(bmSrcFormat) > 0 &&
+           GetDstBytesPerPixel(bmDstFormat) > 0;
+}
+
+/*++
+
+Routine Name:
+
+    CColorLUT::GetSrcBytesPerPixel
+
+Routine Description:
+
+    Retrieves the pixel size for the source formats a LUT can be applied to
+
+Arguments:
+
+    bmFormat - The BMFORMAT to look up
+
+Return Value:
+
+    UINT
+    The count of bytes per pixel, or 0 if the format is not supported
+
+--*/
+UINT
+CColorLUT::GetSrcBytesPerPixel(
+    _In_ CONST BMFORMAT bmFormat
+    )
+{
+    UINT cbPixel = 0;
+
+    switch (bmFormat)
+    {
+        case BM_RGBTRIPLETS:
+        case BM_BGRTRIPLETS:
+        {
+            cbPixel = 3;
+        }
+        break;
+
+        case BM_xRGBQUADS:
+        case BM_xBGRQUADS:
+        {
+            cbPixel = 4;
+        }
+        break;
+
+        default:
+        {
+            cbPixel = 0;
+        }
+        break;
+    }
+
+    return cbPixel;
+}
+
+/*++
+
+Routine Name:
+
+    CColorLUT::GetDstBytesPerPixel
+
+Routine Description:
+
+    Retrieves the pixel size for the destination formats a LUT can generate
+
+Arguments:
+
+    bmFormat - The BMFORMAT to look up
+
+Return Value:
+
+    UINT
+    The count of bytes per pixel, or 0 if the format is not supported
+
+--*/
+UINT
+CColorLUT::GetDstBytesPerPixel(
+    _In_ CONST BMFORMAT bmFormat
+    )
+{
+    UINT cbPixel = 0;
+
+    switch (bmFormat)
+    {
+        case BM_RGBTRIPLETS:
+        case BM_BGRTRIPLETS:
+        {
+            cbPixel = 3;
+        }
+        break;
+
+        case BM_xRGBQUADS:
+        case BM_xBGRQUADS:
+        case BM_CMYKQUADS:
+        case BM_KYMCQUADS:
+        {
+            cbPixel = 4;
+        }
+        break;
+
+        default:
+        {
+            cbPixel = 0;
+        }
+        break;
+    }
+
+    return cbPixel;
+}
+
+/*++
+
+Routine Name:
+
+    CColorLUT::FreeNodes
+
+Routine Description:
+
+    Frees the LUT node data
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+VOID
+CColorLUT::FreeNodes(
+    VOID
+    )
+{
+    if (m_pNodes != NULL)
+    {
+        delete[] m_pNodes;
+        m_pNodes = NULL;
+    }
+
+    m_cbSrcPixel = 0;
+    m_cbDstPixel = 0;
+}
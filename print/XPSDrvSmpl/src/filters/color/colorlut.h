@@ -0,0 +1,97 @@
+/*++
+
+Copyright (c) 2005 Microsoft Corporation
+
+All rights reserved.
+
+THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+PARTICULAR PURPOSE.
+
+File Name:
+
+   colorlut.h
+
+Abstract:
+
+   CColorLUT class definition. This class samples a color transform on a regular 3D grid
+   of 8 bit per channel source colors and applies the transform to bitmap data by
+   tetrahedral interpolation between the grid nodes.
+
+--*/
+
+#pragma once
+
+//
+// The count of grid nodes along each axis of the LUT and the total count of nodes.
+// A transform only gets a LUT once it has translated as many pixels as the LUT has
+// nodes, so building the LUT never costs more than the work already done.
+//
+static CONST UINT kLUTGridPoints = 33;
+static CONST UINT kLUTNodeCount = kLUTGridPoints * kLUTGridPoints * kLUTGridPoints;
+
+class CColorLUT
+{
+public:
+    CColorLUT();
+
+    ~CColorLUT();
+
+    HRESULT
+    Create(
+        _In_ HTRANSFORM     hTrans,
+        _In_ CONST BMFORMAT bmSrcFormat,
+        _In_ CONST BMFORMAT bmDstFormat
+        );
+
+    BOOL
+    Matches(
+        _In_ CONST BMFORMAT bmSrcFormat,
+        _In_ CONST BMFORMAT bmDstFormat
+        ) CONST;
+
+    HRESULT
+    Apply(
+        _In_reads_bytes_(cbSrcStride * cHeight)  PBYTE pSrcData,
+        _In_                                     UINT  cWidth,
+        _In_                                     UINT  cHeight,
+        _In_                                     UINT  cbSrcStride,
+        _Out_writes_bytes_(cbDstStride * cHeight) PBYTE pDstData,
+        _In_                                     UINT  cbDstStride
+        ) CONST;
+
+    static BOOL
+    IsSupported(
+        _In_ CONST BMFORMAT bmSrcFormat,
+        _In_ CONST BMFORMAT bmDstFormat
+        );
+
+private:
+    static UINT
+    GetSrcBytesPerPixel(
+        _In_ CONST BMFORMAT bmFormat
+        );
+
+    static UINT
+    GetDstBytesPerPixel(
+        _In_ CONST BMFORMAT bmFormat
+        );
+
+    VOID
+    FreeNodes(
+        VOID
+        );
+
+private:
+    BMFORMAT m_bmSrcFormat;
+
+    BMFORMAT m_bmDstFormat;
+
+    UINT     m_cbSrcPixel;
+
+    UINT     m_cbDstPixel;
+
+    PBYTE    m_pNodes;
+};
+
@@ -57,6 +57,8 @@ Arguments:
     pszDeviceName - Pointer to a string containing the device name
     cmProfData    - Structure containing color profile settings from the PrintTicket
     cmIntData     - Structure containing color intents settings from the PrintTicket
+    pFP           - Pointer to the fixed page being processed
+    pColorTrans   - Pointer to the transform cache shared by all pages processed by the filter
 
 Return Value:
 
@@ -68,17 +70,20 @@ CProfileManager::CProfileManager(
     _In_ LPCWSTR                               pszDeviceName,
     _In_ PageSourceColorProfileData cmProfData,
     _In_ PageICMRenderingIntentData            cmIntData,
-    _In_ IFixedPage*                           pFP
+    _In_ IFixedPage*                           pFP,
+    _In_ CTransform*                           pColorTrans
     ) :
     m_strDeviceName(pszDeviceName),
     m_cmProfData(cmProfData),
     m_cmIntData(cmIntData),
+    m_pColorTrans(pColorTrans),
     m_pFixedPage(pFP)
 {
     HRESULT hr = S_OK;
 
-    if (SUCCEEDED(hr = CHECK_POINTER(pszDeviceName, E_POINTER)) ||
-        SUCCEEDED(hr = CHECK_POINTER(m_pFixedPage, E_POINTER)))
+    if (SUCCEEDED(hr = CHECK_POINTER(pszDeviceName, E_POINTER)) &&
+        SUCCEEDED(hr = CHECK_POINTER(m_pFixedPage, E_POINTER)) &&
+        SUCCEEDED(hr = CHECK_POINTER(m_pColorTrans, E_POINTER)))
     {
         if(m_strDeviceName.GetLength() <= 0)
         {
@@ -129,6 +134,7 @@ Arguments:
 
     phColorTrans - Pointer to a color transform handle which will contain
                    a transform based off the settings in the PrintTicket
+    pbUseWCS     - Pointer to a BOOL that recieves whether the transform uses WCS
 
 Return Value:
 
@@ -145,8 +151,60 @@ CProfileManager::GetColorTransform(
 {
     HRESULT hr = S_OK;
 
+    HTRANSFORM* phTrans = NULL;
+    UINT        cTrans = 0;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(phColorTrans, E_POINTER)))
+    {
+        *phColorTrans = NULL;
+
+        if (SUCCEEDED(hr = GetColorTransforms(&phTrans, &cTrans, pbUseWCS)))
+        {
+            *phColorTrans = phTrans[0];
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CProfileManager::GetColorTransforms
+
+Routine Description:
+
+    Method which supplies equivalent color transforms based on the settings in the
+    PrintTicket, one for each thread that may transform a bitmap concurrently
+
+Arguments:
+
+    pphColorTrans - Pointer to pointer that recieves the address of the array of transform handles
+                    Note: the buffer is only valid until the next transform is requested.
+    pcColorTrans  - Pointer to storage that recieves the count of handles in the array
+    pbUseWCS      - Pointer to a BOOL that recieves whether the transforms use WCS
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CProfileManager::GetColorTransforms(
+    _Outptr_result_buffer_(*pcColorTrans) HTRANSFORM** pphColorTrans,
+    _Out_                                 UINT*        pcColorTrans,
+    _Out_                                 BOOL*        pbUseWCS
+    )
+{
+    HRESULT hr = S_OK;
+
     if (SUCCEEDED(hr = CHECK_POINTER(pbUseWCS, E_POINTER)) &&
-        SUCCEEDED(hr = CHECK_HANDLE(phColorTrans, E_POINTER)) &&
+        SUCCEEDED(hr = CHECK_POINTER(pphColorTrans, E_POINTER)) &&
+        SUCCEEDED(hr = CHECK_POINTER(pcColorTrans, E_POINTER)) &&
         SUCCEEDED(hr = m_dstProfile.SetProfile(m_cmProfData.cmProfileName)))
     {
         *pbUseWCS = IsVista();
@@ -224,9 +282,9 @@ CProfileManager::GetColorTransform(
                 }
 
                 if (SUCCEEDED(hr) &&
-                    SUCCEEDED(hr = m_colorTrans.CreateTransform(&profileList, intents, flRender)))
+                    SUCCEEDED(hr = m_pColorTrans->CreateTransform(&profileList, intents, flRender)))
                 {
-                    hr = m_colorTrans.GetTransformHandle(phColorTrans);
+                    hr = m_pColorTrans->GetTransformHandles(pphColorTrans, pcColorTrans);
                 }
             }
         }
@@ -247,6 +305,50 @@ CProfileManager::GetColorTransform(
 
 /*++
 
+Routine Name:
+
+    CProfileManager::GetColorLUT
+
+Routine Description:
+
+    Method which supplies a LUT sampled from the current color transform for the
+    source and destination formats, where one is available
+
+Arguments:
+
+    bmSrcFormat - Format of the source data
+    bmDstFormat - Format of the destination data
+    cPixels     - Count of pixels the caller is about to translate
+    ppLUT       - Pointer to a CColorLUT pointer that recieves the LUT, or NULL if none is available
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CProfileManager::GetColorLUT(
+    _In_                      CONST BMFORMAT bmSrcFormat,
+    _In_                      CONST BMFORMAT bmDstFormat,
+    _In_                      CONST UINT     cPixels,
+    _Outptr_result_maybenull_ CColorLUT**    ppLUT
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(ppLUT, E_POINTER)))
+    {
+        hr = m_pColorTrans->GetColorLUT(bmSrcFormat, bmDstFormat, cPixels, ppLUT);
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
 Routine Name:
 
     CProfileManager::GetDstProfileType
@@ -34,7 +34,8 @@ public:
         _In_ LPCWSTR                                                                                 pszDeviceName,
         _In_ XDPrintSchema::PageSourceColorProfile::PageSourceColorProfileData cmProfData,
         _In_ XDPrintSchema::PageICMRenderingIntent::PageICMRenderingIntentData                       cmIntData,
-        _In_ IFixedPage*                                                                             pFP
+        _In_ IFixedPage*                                                                             pFP,
+        _In_ CTransform*                                                                             pColorTrans
         );
 
     virtual ~CProfileManager();
@@ -45,6 +46,21 @@ public:
         _Out_ BOOL*       pbUseWCS
         );
 
+    HRESULT
+    GetColorTransforms(
+        _Outptr_result_buffer_(*pcColorTrans) HTRANSFORM** pphColorTrans,
+        _Out_                                 UINT*        pcColorTrans,
+        _Out_                                 BOOL*        pbUseWCS
+        );
+
+    HRESULT
+    GetColorLUT(
+        _In_                      CONST BMFORMAT bmSrcFormat,
+        _In_                      CONST BMFORMAT bmDstFormat,
+        _In_                      CONST UINT     cPixels,
+        _Outptr_result_maybenull_ CColorLUT**    ppLUT
+        );
+
     HRESULT
     GetDstProfileType(
         _Out_ XDPrintSchema::PageSourceColorProfile::EProfileOption* pType
@@ -119,7 +135,7 @@ private:
 
     CProfile                         m_dstProfile;
 
-    CTransform                       m_colorTrans;
+    CTransform*                      m_pColorTrans;
 
     CComPtr<IFixedPage>              m_pFixedPage;
 };
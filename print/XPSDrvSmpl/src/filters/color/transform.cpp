@@ -16,7 +16,7 @@ File Name:
 Abstract:
 
    CTransform class implementation. This class creates and manages color transforms providing
-   limited caching functionality based off the source profile keys.
+   caching functionality based off the source profile keys.
 
    This file also contains a utility class for handling profile lists.
 
@@ -268,12 +268,7 @@ Return Value:
     None
 
 --*/
-CTransform::CTransform() :
-    m_hColorTrans(NULL),
-    m_intents(INTENT_ABSOLUTE_COLORIMETRIC),
-    m_renderFlags(0),
-    m_pcstrProfileKeys(NULL),
-    m_cProfiles(0)
+CTransform::CTransform()
 {
 }
 
@@ -298,7 +293,7 @@ Return Value:
 --*/
 CTransform::~CTransform()
 {
-    FreeTransform();
+    FreeTransforms();
 }
 
 /*++
@@ -309,7 +304,8 @@ Routine Name:
 
 Routine Description:
 
-    Creates the transform from a vector of CProfile objects
+    Creates the transform from a vector of CProfile objects. If a transform for the same
+    profiles, intent and render flags is already cached it is made current instead.
 
 Arguments:
 
@@ -333,75 +329,19 @@ CTransform::CreateTransform(
 {
     HRESULT hr = S_OK;
 
-    if (intent <= INTENT_ABSOLUTE_COLORIMETRIC)
-    {
-        BOOL bFreeTransform = FALSE;
-
-        if (m_intents != intent)
-        {
-            m_intents = intent;
-            bFreeTransform = TRUE;
-        }
-
-        if (m_renderFlags != renderFlags)
-        {
-            m_renderFlags = renderFlags;
-            bFreeTransform = TRUE;
-        }
-
-        if (bFreeTransform)
-        {
-            FreeTransform();
-        }
-    }
-    else
+    if (intent > INTENT_ABSOLUTE_COLORIMETRIC)
     {
         hr = E_INVALIDARG;
     }
 
-    BOOL bUpdate = FALSE;
+    BOOL bFound = FALSE;
 
     if (SUCCEEDED(hr) &&
         SUCCEEDED(hr = CHECK_POINTER(pProfiles, E_POINTER)) &&
-        SUCCEEDED(hr = UpdateProfiles(pProfiles, &bUpdate)))
+        SUCCEEDED(hr = FindEntry(pProfiles, intent, renderFlags, &bFound)) &&
+        !bFound)
     {
-        try
-        {
-            if (bUpdate)
-            {
-                HPROFILE* phProfiles = NULL;
-                DWORD     cProfiles = 0;
-                CProfileList profileList(pProfiles);
-
-                if (SUCCEEDED(hr = profileList.GetProfileData(&phProfiles, &cProfiles)))
-                {
-                    m_hColorTrans = CreateMultiProfileTransform(phProfiles,
-                                                                cProfiles,
-                                                                &m_intents,
-                                                                1,
-                                                                m_renderFlags,
-                                                                INDEX_DONT_CARE);
-
-                    if (m_hColorTrans == NULL)
-                    {
-                        hr = GetLastErrorAsHResult();
-                    }
-                }
-                else
-                {
-                    hr = E_INVALIDARG;
-                }
-            }
-        }
-        catch (exception& DBG_ONLY(e))
-        {
-            ERR(e.what());
-            hr = E_FAIL;
-        }
-        catch (CXDException& e)
-        {
-            hr = e;
-        }
+        hr = CreateEntry(pProfiles, intent, renderFlags);
     }
 
     ERR_ON_HR(hr);
@@ -440,9 +380,13 @@ CTransform::GetTransformHandle(
     {
         *phTrans = NULL;
 
-        if (SUCCEEDED(hr = CHECK_HANDLE(m_hColorTrans, E_PENDING)))
+        if (m_cache.empty())
         {
-            *phTrans = m_hColorTrans;
+            hr = E_PENDING;
+        }
+        else if (SUCCEEDED(hr = CHECK_HANDLE(m_cache.front()->hTrans[0], E_PENDING)))
+        {
+            *phTrans = m_cache.front()->hTrans[0];
         }
     }
 
@@ -454,48 +398,76 @@ CTransform::GetTransformHandle(
 
 Routine Name:
 
-    CTransform::FreeTransform
+    CTransform::GetTransformHandles
 
 Routine Description:
 
-    Free the current transform
+    Retrieves all the handles created for the current transform. The handles are
+    equivalent; each may be used concurrently by a different thread.
 
 Arguments:
 
-    None
+    pphTrans - Pointer to pointer that recieves the address of the array of transform handles
+               Note: the buffer is only valid until the next call to CreateTransform.
+    pcTrans  - Pointer to storage that recieves the count of handles in the array
 
 Return Value:
 
-    None
+    HRESULT
+    S_OK - On success
+    E_*  - On error
 
 --*/
-VOID
-CTransform::FreeTransform(
-    VOID
+HRESULT
+CTransform::GetTransformHandles(
+    _Outptr_result_buffer_(*pcTrans) HTRANSFORM** pphTrans,
+    _Out_                            UINT*        pcTrans
     )
 {
-    FreeProfileKeysBuffer();
-    if (m_hColorTrans != NULL)
+    HRESULT hr = S_OK;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(pphTrans, E_POINTER)) &&
+        SUCCEEDED(hr = CHECK_POINTER(pcTrans, E_POINTER)))
     {
-        DeleteColorTransform(m_hColorTrans);
-        m_hColorTrans = NULL;
+        *pphTrans = NULL;
+        *pcTrans = 0;
+
+        if (m_cache.empty() ||
+            m_cache.front()->cTrans == 0)
+        {
+            hr = E_PENDING;
+        }
+        else
+        {
+            *pphTrans = m_cache.front()->hTrans;
+            *pcTrans = m_cache.front()->cTrans;
+        }
     }
+
+    ERR_ON_HR(hr);
+    return hr;
 }
 
 /*++
 
 Routine Name:
 
-    CTransform::CreateProfileKeysBuffer
+    CTransform::GetColorLUT
 
 Routine Description:
 
-    Creates a buffer to recieve the keys to the profiles that compse the current
-    trnasform
+    Retrieves a LUT sampled from the current transform for the source and destination
+    formats. The LUT is only built once the transform has translated at least as many
+    pixels as the LUT has nodes; until then, and for formats a LUT cannot handle, no LUT
+    is returned and the caller should use the transform handles directly.
 
 Arguments:
 
-    cProfiles - the count of profiles that compose the transform
+    bmSrcFormat - Format of the source data
+    bmDstFormat - Format of the destination data
+    cPixels     - Count of pixels the caller is about to translate
+    ppLUT       - Pointer to a CColorLUT pointer that recieves the LUT, or NULL if none is available
+                  Note: the LUT is only valid until the next call to CreateTransform.
 
 Return Value:
 
@@ -505,20 +477,73 @@ Return Value:
 
 --*/
 HRESULT
-CTransform::CreateProfileKeysBuffer(
-    _In_ CONST UINT& cProfiles
+CTransform::GetColorLUT(
+    _In_                      CONST BMFORMAT bmSrcFormat,
+    _In_                      CONST BMFORMAT bmDstFormat,
+    _In_                      CONST UINT     cPixels,
+    _Outptr_result_maybenull_ CColorLUT**    ppLUT
     )
 {
     HRESULT hr = S_OK;
 
-    FreeProfileKeysBuffer();
+    if (SUCCEEDED(hr = CHECK_POINTER(ppLUT, E_POINTER)))
+    {
+        *ppLUT = NULL;
 
-    if (cProfiles > 0)
+        if (m_cache.empty() ||
+            m_cache.front()->cTrans == 0)
+        {
+            hr = E_PENDING;
+        }
+    }
+
+    if (SUCCEEDED(hr) &&
+        CColorLUT::IsSupported(bmSrcFormat, bmDstFormat))
     {
-        m_pcstrProfileKeys = new(std::nothrow) CStringXDW[cProfiles];
-        if (SUCCEEDED(hr = CHECK_POINTER(m_pcstrProfileKeys, E_OUTOFMEMORY)))
+        TransformEntry* pEntry = m_cache.front();
+
+        try
         {
-            m_cProfiles = cProfiles;
+            vector<CColorLUT*>::iterator iterLUT = pEntry->luts.begin();
+
+            for (; iterLUT != pEntry->luts.end() && *ppLUT == NULL; iterLUT++)
+            {
+                if ((*iterLUT)->Matches(bmSrcFormat, bmDstFormat))
+                {
+                    *ppLUT = *iterLUT;
+                }
+            }
+
+            if (*ppLUT == NULL)
+            {
+                if (pEntry->cPixelsTranslated < kLUTNodeCount)
+                {
+                    pEntry->cPixelsTranslated += min(cPixels, kLUTNodeCount);
+                }
+                else
+                {
+                    CColorLUT* pLUT = new(std::nothrow) CColorLUT;
+
+                    if (SUCCEEDED(hr = CHECK_POINTER(pLUT, E_OUTOFMEMORY)) &&
+                        SUCCEEDED(hr = pLUT->Create(pEntry->hTrans[0], bmSrcFormat, bmDstFormat)))
+                    {
+                        pEntry->luts.push_back(pLUT);
+                        *ppLUT = pLUT;
+                        pLUT = NULL;
+                    }
+
+                    if (pLUT != NULL)
+                    {
+                        delete pLUT;
+                        pLUT = NULL;
+                    }
+                }
+            }
+        }
+        catch (exception& DBG_ONLY(e))
+        {
+            ERR(e.what());
+            hr = E_FAIL;
         }
     }
 
@@ -530,11 +555,11 @@ CTransform::CreateProfileKeysBuffer(
 
 Routine Name:
 
-    CTransform::FreeProfileKeysBuffer
+    CTransform::FreeTransforms
 
 Routine Description:
 
-    Frees the profile key buffer
+    Free all cached transforms
 
 Arguments:
 
@@ -546,34 +571,82 @@ Return Value:
 
 --*/
 VOID
-CTransform::FreeProfileKeysBuffer(
+CTransform::FreeTransforms(
     VOID
     )
 {
-    if (m_pcstrProfileKeys != NULL)
+    vector<TransformEntry*>::iterator iterEntry = m_cache.begin();
+
+    for (; iterEntry != m_cache.end(); iterEntry++)
     {
-        delete[] m_pcstrProfileKeys;
-        m_pcstrProfileKeys = NULL;
+        FreeEntry(*iterEntry);
     }
 
-    m_cProfiles = 0;
+    m_cache.clear();
 }
 
 /*++
 
 Routine Name:
 
-    CTransform::UpdateProfiles
+    CTransform::FreeEntry
 
 Routine Description:
 
-    Updates the profile list and checks whether the transform needs to be generated
-    (i.e. is the current transform the same as the requested transform)
+    Frees a cache entry and the transform handles it holds
 
 Arguments:
 
-    pProfiles - Pointer to the vector of CProfile objects that have the individual profile data
-    pbUpdate  - Pointer to BOOL that recieves whether the transform requires updating
+    pEntry - Pointer to the cache entry to free
+
+Return Value:
+
+    None
+
+--*/
+VOID
+CTransform::FreeEntry(
+    _In_ TransformEntry* pEntry
+    )
+{
+    if (pEntry != NULL)
+    {
+        for (UINT cTrans = 0; cTrans < pEntry->cTrans; cTrans++)
+        {
+            if (pEntry->hTrans[cTrans] != NULL)
+            {
+                DeleteColorTransform(pEntry->hTrans[cTrans]);
+            }
+        }
+
+        vector<CColorLUT*>::iterator iterLUT = pEntry->luts.begin();
+
+        for (; iterLUT != pEntry->luts.end(); iterLUT++)
+        {
+            delete *iterLUT;
+        }
+
+        delete pEntry;
+    }
+}
+
+/*++
+
+Routine Name:
+
+    CTransform::FindEntry
+
+Routine Description:
+
+    Searches the cache for a transform matching the profiles, intent and render flags
+    and moves it to the front of the cache if found
+
+Arguments:
+
+    pProfiles   - Pointer to the vector of CProfile objects that have the individual profile data
+    intent      - Intent flags the transform was created with
+    renderFlags - Render flags the transform was created with
+    pbFound     - Pointer to BOOL that recieves whether a matching transform was found
 
 Return Value:
 
@@ -583,84 +656,218 @@ Return Value:
 
 --*/
 HRESULT
-CTransform::UpdateProfiles(
+CTransform::FindEntry(
     _In_  ProfileList* pProfiles,
-    _Out_ BOOL*        pbUpdate
+    _In_  CONST DWORD  intent,
+    _In_  CONST DWORD  renderFlags,
+    _Out_ BOOL*        pbFound
     )
 {
     HRESULT hr = S_OK;
 
     if (SUCCEEDED(hr = CHECK_POINTER(pProfiles, E_POINTER)) &&
-        SUCCEEDED(hr = CHECK_POINTER(pbUpdate, E_POINTER)))
+        SUCCEEDED(hr = CHECK_POINTER(pbFound, E_POINTER)))
     {
-        *pbUpdate = FALSE;
+        *pbFound = FALSE;
 
         try
         {
-            //
-            // If we already have a transform, a list of profile keys and matching
-            // number of profiles, check our keys against the incoming list of profiles
-            // and note if we need to create a new transform
-            //
-            CStringXDW* pcstrProfileKeys = NULL;
-            if (m_hColorTrans != NULL &&
-                m_pcstrProfileKeys != NULL &&
-                m_cProfiles > 0 &&
-                m_cProfiles == static_cast<UINT>(pProfiles->size()))
+            vector<TransformEntry*>::iterator iterEntry = m_cache.begin();
+
+            for (; iterEntry != m_cache.end() && !*pbFound; iterEntry++)
             {
-                pcstrProfileKeys = m_pcstrProfileKeys;
-                ProfileList::iterator iterProfiles = pProfiles->begin();
+                TransformEntry* pEntry = *iterEntry;
 
-                for (;
-                     iterProfiles != pProfiles->end() && !*pbUpdate;
-                     iterProfiles++)
+                if (pEntry->intent == intent &&
+                    pEntry->renderFlags == renderFlags &&
+                    pEntry->profileKeys.size() == pProfiles->size())
                 {
-                    if (*(*iterProfiles) != *pcstrProfileKeys++)
+                    BOOL bMatch = TRUE;
+                    ProfileList::iterator iterProfiles = pProfiles->begin();
+                    vector<CStringXDW>::iterator iterKeys = pEntry->profileKeys.begin();
+
+                    for (;
+                         iterProfiles != pProfiles->end() && bMatch;
+                         iterProfiles++, iterKeys++)
                     {
-                        *pbUpdate = TRUE;
+                        if (*(*iterProfiles) != *iterKeys)
+                        {
+                            bMatch = FALSE;
+                        }
                     }
+
+                    if (bMatch)
+                    {
+                        //
+                        // Move the entry to the front so that it becomes the current transform
+                        // and is the last to be evicted
+                        //
+                        m_cache.erase(iterEntry);
+                        m_cache.insert(m_cache.begin(), pEntry);
+                        *pbFound = TRUE;
+                        break;
+                    }
+                }
+            }
+        }
+        catch (exception& DBG_ONLY(e))
+        {
+            ERR(e.what());
+            hr = E_FAIL;
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CTransform::CreateEntry
+
+Routine Description:
+
+    Creates the transform handles for a vector of CProfile objects and adds them to the front
+    of the cache, evicting the least recently used entry if the cache is full. One handle is
+    created per processor up to kMaxTransformsPerEntry so that a bitmap can be transformed
+    on several threads.
+
+Arguments:
+
+    pProfiles   - Pointer to the vector of CProfile objects that have the individual profile data
+    intent      - Intent flags to be applied when creating transform
+    renderFlags - Render flags to be applied when creating transform
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CTransform::CreateEntry(
+    _In_ ProfileList* pProfiles,
+    _In_ CONST DWORD  intent,
+    _In_ CONST DWORD  renderFlags
+    )
+{
+    HRESULT hr = S_OK;
+
+    TransformEntry* pEntry = NULL;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(pProfiles, E_POINTER)))
+    {
+        pEntry = new(std::nothrow) TransformEntry;
+        hr = CHECK_POINTER(pEntry, E_OUTOFMEMORY);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        try
+        {
+            pEntry->intent = intent;
+            pEntry->renderFlags = renderFlags;
+            pEntry->cTrans = 0;
+            pEntry->cPixelsTranslated = 0;
+            ZeroMemory(pEntry->hTrans, sizeof(pEntry->hTrans));
+
+            ProfileList::iterator iterProfiles = pProfiles->begin();
+
+            for (;
+                 SUCCEEDED(hr) && iterProfiles != pProfiles->end();
+                 iterProfiles++)
+            {
+                CStringXDW cstrKey;
+
+                if (SUCCEEDED(hr = (*iterProfiles)->GetProfileKey(&cstrKey)))
+                {
+                    pEntry->profileKeys.push_back(cstrKey);
                 }
             }
-            else
+
+            HPROFILE* phProfiles = NULL;
+            DWORD     cProfiles = 0;
+            CProfileList profileList(pProfiles);
+
+            if (SUCCEEDED(hr) &&
+                FAILED(hr = profileList.GetProfileData(&phProfiles, &cProfiles)))
             {
-                *pbUpdate = TRUE;
+                hr = E_INVALIDARG;
             }
 
-            if (*pbUpdate)
+            if (SUCCEEDED(hr))
             {
-                //
-                // We need to create a new transform. Free any current transform and cache the keys
-                // to the profiles that constitute the transform
-                //
-                FreeTransform();
-                if (SUCCEEDED(hr = CreateProfileKeysBuffer(static_cast<UINT>(pProfiles->size()))))
+                SYSTEM_INFO sysInfo = {0};
+                GetSystemInfo(&sysInfo);
+
+                UINT cTransMax = static_cast<UINT>(sysInfo.dwNumberOfProcessors);
+                if (cTransMax == 0)
                 {
-                    pcstrProfileKeys = m_pcstrProfileKeys;
-                    ProfileList::iterator iterProfiles = pProfiles->begin();
+                    cTransMax = 1;
+                }
+                else if (cTransMax > kMaxTransformsPerEntry)
+                {
+                    cTransMax = kMaxTransformsPerEntry;
+                }
 
-                    for (;
-                         SUCCEEDED(hr) && iterProfiles != pProfiles->end();
-                         iterProfiles++, pcstrProfileKeys++)
+                DWORD intents = intent;
+
+                for (UINT cTrans = 0; SUCCEEDED(hr) && cTrans < cTransMax; cTrans++)
+                {
+                    HTRANSFORM hTrans = CreateMultiProfileTransform(phProfiles,
+                                                                    cProfiles,
+                                                                    &intents,
+                                                                    1,
+                                                                    renderFlags,
+                                                                    INDEX_DONT_CARE);
+
+                    if (hTrans != NULL)
+                    {
+                        pEntry->hTrans[pEntry->cTrans++] = hTrans;
+                    }
+                    else if (cTrans == 0)
+                    {
+                        hr = GetLastErrorAsHResult();
+                    }
+                    else
                     {
                         //
-                        // If CreateProfileKeysBuffer succeeds, it fills
-                        // in m_pcstrProfileKeys with pProfiles->size()
-                        // elements. Hence the _Analysis_assume_.
+                        // Additional handles only allow the work to be split across threads;
+                        // carry on with the handles we already have
                         //
-                        _Analysis_assume_(pcstrProfileKeys != NULL);
-                        hr = (*iterProfiles)->GetProfileKey(pcstrProfileKeys);
+                        break;
                     }
                 }
             }
+
+            if (SUCCEEDED(hr))
+            {
+                if (m_cache.size() >= kMaxCachedTransforms)
+                {
+                    FreeEntry(m_cache.back());
+                    m_cache.pop_back();
+                }
+
+                m_cache.insert(m_cache.begin(), pEntry);
+                pEntry = NULL;
+            }
         }
         catch (exception& DBG_ONLY(e))
         {
             ERR(e.what());
             hr = E_FAIL;
         }
+        catch (CXDException& e)
+        {
+            hr = e;
+        }
     }
 
+    FreeEntry(pEntry);
+
     ERR_ON_HR(hr);
     return hr;
 }
-
@@ -16,7 +16,9 @@ File Name:
 Abstract:
 
    CTransform class definition. This class creates and manages color transforms providing
-   limited caching functionality based off the source profile keys.
+   caching functionality based off the source profile keys. The most recently used
+   transforms are kept so that switching between source profiles (e.g. from image to image
+   or page to page) does not recreate them.
 
 
 --*/
@@ -24,9 +26,18 @@ Abstract:
 #pragma once
 
 #include "profile.h"
+#include "colorlut.h"
 
 typedef vector<CProfile*> ProfileList;
 
+//
+// The maximum count of profile list / intent / flags combinations kept in the cache and the
+// maximum count of transform handles created for each of them. Each handle may be used by one
+// thread at a time, so this also bounds the count of threads a bitmap is transformed with.
+//
+static CONST UINT kMaxCachedTransforms = 8;
+static CONST UINT kMaxTransformsPerEntry = 4;
+
 class CTransform
 {
 public:
@@ -46,38 +57,67 @@ public:
         _Out_ HTRANSFORM* phTrans
         );
 
-
-private:
-    VOID
-    FreeTransform(
-        VOID
+    HRESULT
+    GetTransformHandles(
+        _Outptr_result_buffer_(*pcTrans) HTRANSFORM** pphTrans,
+        _Out_                            UINT*        pcTrans
         );
 
     HRESULT
-    CreateProfileKeysBuffer(
-        _In_ CONST UINT& cProfiles
+    GetColorLUT(
+        _In_                      CONST BMFORMAT bmSrcFormat,
+        _In_                      CONST BMFORMAT bmDstFormat,
+        _In_                      CONST UINT     cPixels,
+        _Outptr_result_maybenull_ CColorLUT**    ppLUT
         );
 
+private:
+    struct TransformEntry
+    {
+        vector<CStringXDW> profileKeys;
+
+        DWORD              intent;
+
+        DWORD              renderFlags;
+
+        HTRANSFORM         hTrans[kMaxTransformsPerEntry];
+
+        UINT               cTrans;
+
+        vector<CColorLUT*> luts;
+
+        UINT               cPixelsTranslated;
+    };
+
     VOID
-    FreeProfileKeysBuffer(
+    FreeTransforms(
         VOID
         );
 
+    VOID
+    FreeEntry(
+        _In_ TransformEntry* pEntry
+        );
+
     HRESULT
-    UpdateProfiles(
+    FindEntry(
         _In_  ProfileList* pProfiles,
-        _Out_ BOOL*        pbUpdate
+        _In_  CONST DWORD  intent,
+        _In_  CONST DWORD  renderFlags,
+        _Out_ BOOL*        pbFound
         );
 
-private:
-    HTRANSFORM  m_hColorTrans;
-
-    DWORD       m_intents;
-
-    DWORD       m_renderFlags;
-
-    CStringXDW* m_pcstrProfileKeys;
+    HRESULT
+    CreateEntry(
+        _In_ ProfileList* pProfiles,
+        _In_ CONST DWORD  intent,
+        _In_ CONST DWORD  renderFlags
+        );
 
-    DWORD       m_cProfiles;
+private:
+    //
+    // Cached transforms, most recently used first. The front entry is the current transform.
+    //
+    vector<TransformEntry*> m_cache;
 };
 
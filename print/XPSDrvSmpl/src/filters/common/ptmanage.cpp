@@ -68,6 +68,7 @@ CPTManager::CPTManager() :
     m_pDocPT(NULL),
     m_pPagePT(NULL),
     m_hProvider(NULL),
+    m_pCachedPC(NULL),
     m_hToken(INVALID_HANDLE_VALUE)
 {
 }
@@ -528,12 +529,14 @@ Routine Name:
 
 Routine Description:
 
-    This routine retrieves a PrintCapabilities document given a PrintTicket
+    This routine retrieves a PrintCapabilities document given a PrintTicket. If the
+    PrintTicket is the same as on the previous call, the same PrintCapabilities document
+    is returned; callers must not modify it.
 
 Arguments:
 
-    pTicket - Pointer to the PrintTicket as a DOM document
-    pTicket - Pointer to a DOM document pointer that recieves the PrintCapabilities
+    pTicket        - Pointer to the PrintTicket as a DOM document
+    ppCapabilities - Pointer to a DOM document pointer that recieves the PrintCapabilities
 
 Return Value:
 
@@ -555,6 +558,17 @@ CPTManager::GetCapabilities(
     {
         *ppCapabilities = NULL;
 
+        CComBSTR bstrTicket;
+        BOOL     bCached = FALSE;
+
+        if (SUCCEEDED(pTicket->get_xml(&bstrTicket)) &&
+            m_pCachedPC != NULL &&
+            bstrTicket == m_bstrCachedPCTicket)
+        {
+            hr = m_pCachedPC.CopyTo(ppCapabilities);
+            bCached = TRUE;
+        }
+
         CComBSTR bstrError;
         CComPtr<IStream> pPTIn(NULL);
         CComPtr<IStream> pPCOut(NULL);
@@ -564,7 +578,8 @@ CPTManager::GetCapabilities(
         // Create the PrintCapabilities DOM document, retrieve the IStreams from the
         // DOM documents and call the PT api to retrieve the capabilities document
         //
-        if (SUCCEEDED(hr = pCapabilitiesDoc.CoCreateInstance(CLSID_DOMDocument60)) &&
+        if (!bCached &&
+            SUCCEEDED(hr = pCapabilitiesDoc.CoCreateInstance(CLSID_DOMDocument60)) &&
             SUCCEEDED(hr = pTicket->QueryInterface(IID_IStream, reinterpret_cast<VOID**>(&pPTIn))) &&
             SUCCEEDED(hr = pCapabilitiesDoc->QueryInterface(IID_IStream, reinterpret_cast<VOID**>(&pPCOut))))
         {
@@ -575,6 +590,9 @@ CPTManager::GetCapabilities(
                     LARGE_INTEGER cbMove = {0};
                     if (SUCCEEDED(hr = pPCOut->Seek(cbMove, STREAM_SEEK_SET, NULL)))
                     {
+                        m_pCachedPC = pCapabilitiesDoc;
+                        m_bstrCachedPCTicket.Attach(bstrTicket.Detach());
+
                         *ppCapabilities = pCapabilitiesDoc.Detach();
                     }
                 }
@@ -1108,6 +1126,9 @@ CPTManager::CloseProvider(
         m_hProvider = NULL;
     }
 
+    m_pCachedPC = NULL;
+    m_bstrCachedPCTicket.Empty();
+
     return hr;
 }
 
@@ -148,6 +148,15 @@ private:
 
     HPTPROVIDER               m_hProvider;
 
+    //
+    // The last PrintCapabilities retrieved and the PrintTicket it was retrieved for.
+    // Consecutive pages usually share a PrintTicket so this avoids a round trip
+    // to the PrintTicket provider for each page.
+    //
+    CComPtr<IXMLDOMDocument2> m_pCachedPC;
+
+    CComBSTR                  m_bstrCachedPCTicket;
+
     HANDLE                    m_hToken;
 };
 
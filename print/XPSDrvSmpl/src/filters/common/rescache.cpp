@@ -26,6 +26,9 @@ Abstract:
    care of writing the resource via the IResWriter::WriteData method if it has
    not already been written.
 
+   This file also implements the content hash used to build content keys for
+   resources.
+
 --*/
 
 #include "precomp.h"
@@ -91,6 +94,8 @@ Routine Description:
     This template function writes a resource to a fixed page. The type
     of resource is supplied as an argument to the template. The resource
     data is written via the IResWriter interface passed to the method.
+    If the writer supplies a content key matching a resource already written,
+    the existing part is shared instead of writing the data again.
 
 Arguments:
 
@@ -128,7 +133,36 @@ CFileResourceCache::WriteResource(
         if (SUCCEEDED(hr = pResWriter->GetKeyName(&bstrKeyName)) &&
             SUCCEEDED(hr = pResWriter->GetResURI(&bstrURI)))
         {
-            if (!Cached(bstrKeyName))
+            BOOL     bShared = FALSE;
+            CComBSTR bstrContentKey;
+
+            if (!Cached(bstrKeyName) &&
+                SUCCEEDED(pResWriter->GetContentKey(&bstrContentKey)) &&
+                bstrContentKey.Length() > 0)
+            {
+                try
+                {
+                    ContentCache::const_iterator iterContent = m_contentMap.find(bstrContentKey);
+
+                    if (iterContent != m_contentMap.end())
+                    {
+                        //
+                        // The same content has been written under another name - share that part
+                        //
+                        m_resMap[CComBSTR(bstrKeyName)] = m_resMap[iterContent->second];
+                        bShared = TRUE;
+                    }
+                }
+                catch (exception& DBG_ONLY(e))
+                {
+                    ERR(e.what());
+                    hr = E_FAIL;
+                }
+            }
+
+            if (SUCCEEDED(hr) &&
+                !bShared &&
+                !Cached(bstrKeyName))
             {
                 //
                 // The resource is not cached:
@@ -156,6 +190,11 @@ CFileResourceCache::WriteResource(
                         {
                             m_resMap[CComBSTR(bstrKeyName)].first = bstrURI;
                             m_resMap[CComBSTR(bstrKeyName)].second = pPartBase;
+
+                            if (bstrContentKey.Length() > 0)
+                            {
+                                m_contentMap[bstrContentKey] = bstrKeyName;
+                            }
                         }
                     }
                     catch (exception& DBG_ONLY(e))
@@ -307,3 +346,314 @@ CFileResourceCache::Cached(
     return bCached;
 }
 
+
+/*++
+
+Routine Name:
+
+    CContentHash::CContentHash
+
+Routine Description:
+
+    CContentHash class constructor. Creates a SHA-256 hash object.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+    Throws CXDException(HRESULT) on an error
+
+--*/
+CContentHash::CContentHash() :
+    m_hProv(NULL),
+    m_hHash(NULL)
+{
+    HRESULT hr = S_OK;
+
+    if (!CryptAcquireContext(&m_hProv, NULL, NULL, PROV_RSA_AES, CRYPT_VERIFYCONTEXT) ||
+        !CryptCreateHash(m_hProv, CALG_SHA_256, 0, 0, &m_hHash))
+    {
+        hr = GetLastErrorAsHResult();
+    }
+
+    if (FAILED(hr))
+    {
+        if (m_hProv != NULL)
+        {
+            CryptReleaseContext(m_hProv, 0);
+            m_hProv = NULL;
+        }
+
+        throw CXDException(hr);
+    }
+}
+
+/*++
+
+Routine Name:
+
+    CContentHash::~CContentHash
+
+Routine Description:
+
+    CContentHash class destructor
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+CContentHash::~CContentHash()
+{
+    if (m_hHash != NULL)
+    {
+        CryptDestroyHash(m_hHash);
+        m_hHash = NULL;
+    }
+
+    if (m_hProv != NULL)
+    {
+        CryptReleaseContext(m_hProv, 0);
+        m_hProv = NULL;
+    }
+}
+
+/*++
+
+Routine Name:
+
+    CContentHash::HashData
+
+Routine Description:
+
+    Adds a buffer to the hash
+
+Arguments:
+
+    pData  - Pointer to the data to hash
+    cbData - Size of the data in bytes
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CContentHash::HashData(
+    _In_reads_bytes_(cbData) CONST BYTE* pData,
+    _In_                     ULONG       cbData
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(pData, E_POINTER)) &&
+        !CryptHashData(m_hHash, pData, cbData, 0))
+    {
+        hr = GetLastErrorAsHResult();
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CContentHash::HashString
+
+Routine Description:
+
+    Adds a string, including its terminator, to the hash. The terminator keeps
+    consecutive strings from hashing the same as their concatenation.
+
+Arguments:
+
+    szData - The string to hash
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CContentHash::HashString(
+    _In_z_ LPCWSTR szData
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(szData, E_POINTER)))
+    {
+        hr = HashData(reinterpret_cast<CONST BYTE*>(szData),
+                      static_cast<ULONG>((wcslen(szData) + 1) * sizeof(WCHAR)));
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CContentHash::HashPart
+
+Routine Description:
+
+    Adds the content of a part referred to by a fixed page to the hash. The
+    size of the part is hashed after the content.
+
+Arguments:
+
+    pFixedPage  - The fixed page the part is related to
+    bstrPartURI - The URI of the part
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CContentHash::HashPart(
+    _In_ IFixedPage* pFixedPage,
+    _In_ BSTR        bstrPartURI
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(pFixedPage, E_POINTER)))
+    {
+        if (SysStringLen(bstrPartURI) == 0)
+        {
+            hr = E_INVALIDARG;
+        }
+    }
+
+    CComPtr<IUnknown>         pUnk(NULL);
+    CComPtr<IPartBase>        pPart(NULL);
+    CComPtr<IPrintReadStream> pRead(NULL);
+
+    if (SUCCEEDED(hr) &&
+        SUCCEEDED(hr = pFixedPage->GetPagePart(bstrPartURI, &pUnk)) &&
+        SUCCEEDED(hr = pUnk.QueryInterface(&pPart)) &&
+        SUCCEEDED(hr = pPart->GetStream(&pRead)))
+    {
+        PBYTE pBuff = new(std::nothrow) BYTE[CB_COPY_BUFFER];
+
+        ULONGLONG cbTotal = 0;
+
+        if (SUCCEEDED(hr = CHECK_POINTER(pBuff, E_OUTOFMEMORY)) &&
+            SUCCEEDED(hr = pRead->Seek(0, STREAM_SEEK_SET, NULL)))
+        {
+            ULONG cbRead = 0;
+            BOOL  bEOF = FALSE;
+
+            do
+            {
+                if (SUCCEEDED(hr = pRead->ReadBytes(pBuff, CB_COPY_BUFFER, &cbRead, &bEOF)) &&
+                    cbRead > 0)
+                {
+                    hr = HashData(pBuff, cbRead);
+                    cbTotal += cbRead;
+                }
+            }
+            while (SUCCEEDED(hr) &&
+                   !bEOF &&
+                   cbRead > 0);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = HashData(reinterpret_cast<CONST BYTE*>(&cbTotal), sizeof(cbTotal));
+        }
+
+        if (pBuff != NULL)
+        {
+            delete[] pBuff;
+            pBuff = NULL;
+        }
+
+        //
+        // Leave the stream at the start for the next reader
+        //
+        pRead->Seek(0, STREAM_SEEK_SET, NULL);
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CContentHash::GetKey
+
+Routine Description:
+
+    Retrieves the hash of everything added so far as a hexadecimal string. No more data
+    can be added to the hash once the key has been retrieved.
+
+Arguments:
+
+    pbstrKey - Pointer to a BSTR that recieves the key
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CContentHash::GetKey(
+    _Outptr_ BSTR* pbstrKey
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(pbstrKey, E_POINTER)))
+    {
+        *pbstrKey = NULL;
+
+        BYTE  hash[32] = {0};
+        DWORD cbHash = sizeof(hash);
+
+        if (CryptGetHashParam(m_hHash, HP_HASHVAL, hash, &cbHash, 0))
+        {
+            WCHAR szKey[sizeof(hash) * 2 + 1] = {0};
+
+            for (DWORD cbIndex = 0; SUCCEEDED(hr) && cbIndex < cbHash; cbIndex++)
+            {
+                hr = StringCchPrintfW(szKey + cbIndex * 2, 3, L"%02x", hash[cbIndex]);
+            }
+
+            if (SUCCEEDED(hr))
+            {
+                *pbstrKey = SysAllocString(szKey);
+                hr = CHECK_POINTER(*pbstrKey, E_OUTOFMEMORY);
+            }
+        }
+        else
+        {
+            hr = GetLastErrorAsHResult();
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
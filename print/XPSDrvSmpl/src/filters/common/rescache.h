@@ -26,6 +26,10 @@ Abstract:
    the resource cache and it will take care of writing the resource via the
    IResWriter::WriteData method if it has not already been written.
 
+   Resource writers can also supply a key derived from the content of the
+   resource. Resources with matching content keys share a single part even
+   when they are referred to under different names.
+
 --*/
 
 #pragma once
@@ -39,6 +43,11 @@ Abstract:
 typedef pair<CComBSTR, CComPtr<IPartBase> > URIPartPair;
 typedef map<CComBSTR ,URIPartPair> ResCache;
 
+//
+// Map from a content key to the name of the first resource written with that content
+//
+typedef map<CComBSTR, CComBSTR> ContentCache;
+
 class IResWriter
 {
 public:
@@ -62,6 +71,61 @@ public:
         _Outptr_ BSTR* pbstrResURI
         ) = 0;
 
+    //
+    // Writers that can identify their output by content override this to return
+    // a key that is identical for any two resources that would be written identically
+    //
+    virtual HRESULT
+    GetContentKey(
+        _Outptr_result_maybenull_ BSTR* pbstrContentKey
+        )
+    {
+        HRESULT hr = S_OK;
+
+        if (SUCCEEDED(hr = CHECK_POINTER(pbstrContentKey, E_POINTER)))
+        {
+            *pbstrContentKey = NULL;
+            hr = E_NOTIMPL;
+        }
+
+        return hr;
+    }
+
+};
+
+class CContentHash
+{
+public:
+    CContentHash();
+
+    ~CContentHash();
+
+    HRESULT
+    HashData(
+        _In_reads_bytes_(cbData) CONST BYTE* pData,
+        _In_                     ULONG       cbData
+        );
+
+    HRESULT
+    HashString(
+        _In_z_ LPCWSTR szData
+        );
+
+    HRESULT
+    HashPart(
+        _In_ IFixedPage* pFixedPage,
+        _In_ BSTR        bstrPartURI
+        );
+
+    HRESULT
+    GetKey(
+        _Outptr_ BSTR* pbstrKey
+        );
+
+private:
+    HCRYPTPROV m_hProv;
+
+    HCRYPTHASH m_hHash;
 };
 
 class CFileResourceCache
@@ -92,7 +156,9 @@ protected:
         );
 
 private:
-    ResCache m_resMap;
+    ResCache     m_resMap;
+
+    ContentCache m_contentMap;
 };
 
 //
@@ -40,6 +40,7 @@ _Analysis_mode_(_Analysis_code_type_user_driver_)
 #endif // WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #include <windowsx.h>
+#include <wincrypt.h>
 
 //
 // COM includes
@@ -44,6 +44,49 @@ using XDPrintSchema::PageWatermark::VectorWatermark;
 
 /*++
 
+Routine Name:
+
+    IsSameWatermark
+
+Routine Description:
+
+    Compares two sets of watermark settings. Pages with the same settings
+    share a single watermark object so the resources and mark-up are only
+    generated once.
+
+Arguments:
+
+    wmData1 - First set of watermark settings
+    wmData2 - Second set of watermark settings
+
+Return Value:
+
+    BOOL
+    TRUE  - The settings describe the same watermark
+    FALSE - The settings differ
+
+--*/
+static BOOL
+IsSameWatermark(
+    _In_ CONST WatermarkData& wmData1,
+    _In_ CONST WatermarkData& wmData2
+    )
+{
+    return wmData1.type                  == wmData2.type &&
+           wmData1.widthOrigin           == wmData2.widthOrigin &&
+           wmData1.heightOrigin          == wmData2.heightOrigin &&
+           wmData1.widthExtent           == wmData2.widthExtent &&
+           wmData1.heightExtent          == wmData2.heightExtent &&
+           wmData1.transparency          == wmData2.transparency &&
+           wmData1.angle                 == wmData2.angle &&
+           wmData1.layering              == wmData2.layering &&
+           wmData1.txtData.fontSize      == wmData2.txtData.fontSize &&
+           wmData1.txtData.bstrFontColor == wmData2.txtData.bstrFontColor &&
+           wmData1.txtData.bstrText      == wmData2.txtData.bstrText;
+}
+
+/*++
+
 Routine Name:
 
     CWatermarkFilter::CWatermarkFilter
@@ -61,7 +104,8 @@ Return Value:
     None
 
 --*/
-CWatermarkFilter::CWatermarkFilter()
+CWatermarkFilter::CWatermarkFilter() :
+    m_pWatermark(NULL)
 {
     ASSERTMSG(m_gdiPlus.GetGDIPlusStartStatus() == Ok, "GDI plus is not correctly initialized.\n");
 }
@@ -87,6 +131,11 @@ Return Value:
 --*/
 CWatermarkFilter::~CWatermarkFilter()
 {
+    if (m_pWatermark != NULL)
+    {
+        delete m_pWatermark;
+        m_pWatermark = NULL;
+    }
 }
 
 /*++
@@ -213,15 +262,6 @@ CWatermarkFilter::ProcessPart(
         }
     }
 
-    //
-    // Clean up the watermark if it was successfully created
-    //
-    if (pWatermark != NULL)
-    {
-        delete pWatermark;
-        pWatermark = NULL;
-    }
-
     if (SUCCEEDED(hr))
     {
         //
@@ -242,7 +282,8 @@ Routine Name:
 
 Routine Description:
 
-    Method for obtaining the watermark PrintTicket preferences
+    Method for obtaining the watermark PrintTicket preferences. The watermark
+    is owned by the filter and reused for following pages with the same settings
 
 Arguments:
 
@@ -276,8 +317,20 @@ CWatermarkFilter::GetWatermark(
             CWMPTHandler  wmPTHandler(pPrintTicket);
             WatermarkData wmData;
 
-            if (SUCCEEDED(hr = wmPTHandler.GetData(&wmData)))
+            if (SUCCEEDED(hr = wmPTHandler.GetData(&wmData)) &&
+                m_pWatermark != NULL &&
+                IsSameWatermark(wmData, m_wmData))
             {
+                *ppWatermark = m_pWatermark;
+            }
+            else if (SUCCEEDED(hr))
+            {
+                if (m_pWatermark != NULL)
+                {
+                    delete m_pWatermark;
+                    m_pWatermark = NULL;
+                }
+
                 CWMPTProperties wmProperties(wmData);
 
                 EWatermarkOption wmOption;
@@ -326,6 +379,12 @@ CWatermarkFilter::GetWatermark(
                         break;
                     }
                 }
+
+                if (SUCCEEDED(hr))
+                {
+                    m_pWatermark = *ppWatermark;
+                    m_wmData = wmData;
+                }
             }
         }
         catch (CXDException& e)
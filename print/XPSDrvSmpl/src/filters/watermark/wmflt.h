@@ -50,5 +50,9 @@ private:
 
 private:
     GDIPlus                   m_gdiPlus;
+
+    CWatermark*               m_pWatermark;
+
+    XDPrintSchema::PageWatermark::WatermarkData m_wmData;
 };
 
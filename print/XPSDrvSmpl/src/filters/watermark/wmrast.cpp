@@ -143,11 +143,14 @@ CRasterWatermark::CreateXMLElement(
 
     //
     // We need to retrieve the bitmap bounds to calculate
-    // the correct render transform for the watermark
+    // the correct render transform for the watermark. The element only
+    // depends on the PrintTicket settings and the image URI so it is
+    // only built once for all the pages sharing this watermark
     //
     SizeF bmpDims;
     CComBSTR bstrWMOpacity;
     if (SUCCEEDED(hr) &&
+        m_pWMElem == NULL &&
         SUCCEEDED(hr = m_wmBMP.GetImageDimensions(&bmpDims)) &&
         SUCCEEDED(hr = m_WMProps.GetOpacity(&bstrWMOpacity)))
     {
@@ -253,15 +256,22 @@ CRasterWatermark::AddParts(
         SUCCEEDED(hr = CHECK_POINTER(pResCache, E_POINTER)))
     {
         //
-        // Write the font resource to the cache
+        // Write the bitmap resource to the cache. This is only written
+        // once for the job; later pages just add a reference to the part
         //
-        m_bstrImageURI.Empty();
         CComBSTR bstrKey;
+        CComBSTR bstrURI;
         if (SUCCEEDED(hr = m_wmBMP.CheckResID()) &&
             SUCCEEDED(hr = pResCache->WriteResource<IPartImage>(pXpsConsumer, pFixedPage, &m_wmBMP)) &&
-            SUCCEEDED(hr = m_wmBMP.GetKeyName(&bstrKey)))
+            SUCCEEDED(hr = m_wmBMP.GetKeyName(&bstrKey)) &&
+            SUCCEEDED(hr = pResCache->GetURI(bstrKey, &bstrURI)) &&
+            bstrURI != m_bstrImageURI)
         {
-            hr = pResCache->GetURI(bstrKey, &m_bstrImageURI);
+            //
+            // The URI is part of the page markup so the element has to be rebuilt
+            //
+            m_pWMElem = NULL;
+            m_bstrImageURI.Attach(bstrURI.Detach());
         }
     }
 
@@ -147,7 +147,12 @@ CTextWatermark::CreateXMLElement(
     CComBSTR bstrWMFontSize;
     CComBSTR bstrWMFontColor;
 
+    //
+    // The element only depends on the PrintTicket settings and the font URI
+    // so it is only built once for all the pages sharing this watermark
+    //
     if (SUCCEEDED(hr) &&
+        m_pWMElem == NULL &&
         SUCCEEDED(hr = m_WMProps.GetText(&bstrWMText)) &&
         SUCCEEDED(hr = m_WMProps.GetFontColor(&bstrWMFontColor)) &&
         SUCCEEDED(hr = m_WMProps.GetFontEmSize(&bstrWMFontSize)) &&
@@ -235,12 +240,18 @@ CTextWatermark::AddParts(
         //
         // Write the font resource to the cache
         //
-        m_bstrFontURI.Empty();
         CComBSTR bstrKey;
+        CComBSTR bstrURI;
         if (SUCCEEDED(hr = pResCache->WriteResource<IPartFont>(pXpsConsumer, pFixedPage, &m_wmFont)) &&
-            SUCCEEDED(hr = m_wmFont.GetKeyName(&bstrKey)))
+            SUCCEEDED(hr = m_wmFont.GetKeyName(&bstrKey)) &&
+            SUCCEEDED(hr = pResCache->GetURI(bstrKey, &bstrURI)) &&
+            bstrURI != m_bstrFontURI)
         {
-            hr = pResCache->GetURI(bstrKey, &m_bstrFontURI);
+            //
+            // The URI is part of the page markup so the element has to be rebuilt
+            //
+            m_pWMElem = NULL;
+            m_bstrFontURI.Attach(bstrURI.Detach());
         }
     }
 
@@ -129,17 +129,31 @@ CVectorWatermark::CreateXMLElement(
     )
 {
     ASSERTMSG(m_pDOMDoc != NULL, "NULL DOM document detected whilst creating text watermark\n");
+    ASSERTMSG(m_bstrDictionaryURI.Length() > 0, "Invalid dictionary URI detected whilst creating vector watermark\n");
 
     HRESULT hr = S_OK;
 
+    if (SUCCEEDED(hr = CHECK_POINTER(m_pDOMDoc, E_PENDING)))
+    {
+        if (m_bstrDictionaryURI.Length() == 0)
+        {
+            hr = E_PENDING;
+        }
+    }
+
     //
     // We need to retrieve the RAW Markup bounds to calculate
-    // the correct render transform for the watermark
+    // the correct render transform for the watermark. The markup only
+    // depends on the PrintTicket settings and the dictionary URI so it
+    // is only built once for all the pages sharing this watermark
     //
     SizeF markupDims;
     CComBSTR bstrWMOpacity;
-    if (SUCCEEDED(hr = CHECK_POINTER(m_pDOMDoc, E_PENDING)) &&
+    CComBSTR bstrBrushKey;
+    if (SUCCEEDED(hr) &&
+        m_bstrMarkup.Length() == 0 &&
         SUCCEEDED(hr = m_wmMarkup.GetImageDimensions(&markupDims)) &&
+        SUCCEEDED(hr = m_wmMarkup.GetBrushKey(&bstrBrushKey)) &&
         SUCCEEDED(hr = m_WMProps.GetOpacity(&bstrWMOpacity)))
     {
         //
@@ -148,8 +162,13 @@ CVectorWatermark::CreateXMLElement(
         //
         // <Canvas
         //     Opacity="[appropriate transparency value]"
-        //     RenderTransform="[appropriate to scale, translate and rotate to the PT settings]"
-        //     [Raw Markup]
+        //     RenderTransform="[appropriate to scale, translate and rotate to the PT settings]">
+        //     <Canvas.Resources>
+        //         <ResourceDictionary Source="[dictionary URI from cache]" />
+        //     </Canvas.Resources>
+        //     <Path
+        //         Data="M [corner coords of markup] z"
+        //         Fill="{StaticResource [brush key]}" />
         // </Canvas>
         //
         CComBSTR bstrMatrixXForm;
@@ -158,23 +177,21 @@ CVectorWatermark::CreateXMLElement(
         {
             try
             {
-                CStringXDW strOpenCanvas;
-                strOpenCanvas.Format(L"<Canvas Opacity=\"%s\" RenderTransform=\"%s\">", bstrWMOpacity, bstrMatrixXForm);
-
-                IStream* pStream;
-                CComBSTR bstrContent;
-
-                if (SUCCEEDED(hr = m_wmMarkup.GetStream(&pStream)) &&
-                    SUCCEEDED(hr = bstrContent.ReadFromStream(pStream)))
-                {
-                    m_bstrMarkup.Empty();
-
-                    if (SUCCEEDED(hr = m_bstrMarkup.Append(strOpenCanvas)) &&
-                        SUCCEEDED(hr = m_bstrMarkup.Append(bstrContent)))
-                    {
-                        hr = m_bstrMarkup.Append(L"</Canvas>\n");
-                    }
-                }
+                CStringXDW strCanvas;
+                strCanvas.Format(L"<Canvas Opacity=\"%s\" RenderTransform=\"%s\">\n"
+                                 L"<Canvas.Resources><ResourceDictionary Source=\"%s\" /></Canvas.Resources>\n"
+                                 L"<Path Data=\"M 0,0 L 0,%.2f %.2f,%.2f %.2f,0 z\" Fill=\"{StaticResource %s}\" />\n"
+                                 L"</Canvas>\n",
+                                 bstrWMOpacity,
+                                 bstrMatrixXForm,
+                                 m_bstrDictionaryURI,
+                                 markupDims.Height,
+                                 markupDims.Width,
+                                 markupDims.Height,
+                                 markupDims.Width,
+                                 bstrBrushKey);
+
+                hr = m_bstrMarkup.Append(strCanvas);
             }
             catch (CXDException& e)
             {
@@ -246,8 +263,7 @@ Routine Name:
 
 Routine Description:
 
-    Method to add any required resource to the cache.
-    This isn't required for vector based watermarks.
+    Method to add the watermark resource dictionary to the cache
 
 Arguments:
 
@@ -264,15 +280,37 @@ Return Value:
 --*/
 HRESULT
 CVectorWatermark::AddParts(
-    _In_ IXpsDocumentConsumer*,
-    _In_ IFixedPage*,
-    _In_ CFileResourceCache*
+    _In_ IXpsDocumentConsumer* pXpsConsumer,
+    _In_ IFixedPage*           pFixedPage,
+    _In_ CFileResourceCache*   pResCache
     )
 {
-    //
-    // No Implementation required.
-    //
+    HRESULT hr = S_OK;
 
-    return S_OK;
+    if (SUCCEEDED(hr = CHECK_POINTER(pXpsConsumer, E_POINTER)) &&
+        SUCCEEDED(hr = CHECK_POINTER(pFixedPage, E_POINTER)) &&
+        SUCCEEDED(hr = CHECK_POINTER(pResCache, E_POINTER)))
+    {
+        //
+        // Write the resource dictionary to the cache. This is only written
+        // once for the job; later pages just add a reference to the part
+        //
+        CComBSTR bstrKey;
+        CComBSTR bstrURI;
+        if (SUCCEEDED(hr = pResCache->WriteResource<IPartResourceDictionary>(pXpsConsumer, pFixedPage, &m_wmMarkup)) &&
+            SUCCEEDED(hr = m_wmMarkup.GetKeyName(&bstrKey)) &&
+            SUCCEEDED(hr = pResCache->GetURI(bstrKey, &bstrURI)) &&
+            bstrURI != m_bstrDictionaryURI)
+        {
+            //
+            // The URI is part of the page markup so the markup has to be rebuilt
+            //
+            m_bstrMarkup.Empty();
+            m_bstrDictionaryURI.Attach(bstrURI.Detach());
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
 }
 
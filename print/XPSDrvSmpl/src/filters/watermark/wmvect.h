@@ -17,7 +17,8 @@ Abstract:
 
    VectorGraphic watermark class definition. CVectorWatermark is the
    Vector implementation of the CWatermark class. This implements methods
-   for creating the page mark-up and adding the watermark resource to fixed page.
+   for creating the page mark-up and adding the watermark resource dictionary to
+   the fixed page.
 
 --*/
 
@@ -58,5 +59,7 @@ private:
     CWatermarkMarkup  m_wmMarkup;
 
     CComBSTR          m_bstrMarkup;
+
+    CComBSTR          m_bstrDictionaryURI;
 };
 
@@ -16,7 +16,8 @@ File Name:
 Abstract:
 
    Watermark XPS markup class implementation. The CWatermarkMarkup class is responsible
-   for creating a stream that contains markup loaded from a resource.
+   for creating a stream that contains markup loaded from a resource and for writing
+   that markup out as a shared resource dictionary.
 
 --*/
 
@@ -24,6 +25,8 @@ Abstract:
 #include "debug.h"
 #include "globals.h"
 #include "xdexcept.h"
+#include "xdstring.h"
+#include "widetoutf8.h"
 #include "wmxps.h"
 
 using XDPrintSchema::PageWatermark::EWatermarkOption;
@@ -289,3 +292,254 @@ CWatermarkMarkup::GetStream(
     ERR_ON_HR(hr);
     return hr;
 }
+
+/*++
+
+Routine Name:
+
+    CWatermarkMarkup::WriteData
+
+Routine Description:
+
+    Method for writing out the vector image to the container as a remote
+    resource dictionary. The markup is wrapped in a VisualBrush so that each
+    page only needs to reference the brush rather than repeat the markup
+
+Arguments:
+
+    pResource - Pointer to the resource dictionary part
+    pStream   - Pointer to the stream to write the resource dictionary out to
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CWatermarkMarkup::WriteData(
+    _In_ IPartBase*         pResource,
+    _In_ IPrintWriteStream* pStream
+    )
+{
+    HRESULT hr = S_OK;
+
+    SizeF    markupDims;
+    CComBSTR bstrBrushKey;
+    IStream* pXPSStream = NULL;
+    CComBSTR bstrContent;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(pResource, E_POINTER)) &&
+        SUCCEEDED(hr = CHECK_POINTER(pStream, E_POINTER)) &&
+        SUCCEEDED(hr = GetImageDimensions(&markupDims)) &&
+        SUCCEEDED(hr = GetBrushKey(&bstrBrushKey)) &&
+        SUCCEEDED(hr = GetStream(&pXPSStream)) &&
+        SUCCEEDED(hr = bstrContent.ReadFromStream(pXPSStream)))
+    {
+        //
+        // The dictionary will look like this (square bracketed values "[]"
+        // describes content):
+        //
+        // <ResourceDictionary xmlns="..." xmlns:x="...">
+        //     <VisualBrush
+        //         x:Key="[brush key]"
+        //         ViewboxUnits="Absolute"
+        //         Viewbox="[markup bounds]"
+        //         ViewportUnits="Absolute"
+        //         Viewport="[markup bounds]">
+        //         <VisualBrush.Visual>
+        //             <Canvas>[Raw Markup]</Canvas>
+        //         </VisualBrush.Visual>
+        //     </VisualBrush>
+        // </ResourceDictionary>
+        //
+        try
+        {
+            CStringXDW cstrDictionary;
+            cstrDictionary.Format(L"<ResourceDictionary xmlns=\"http://schemas.microsoft.com/xps/2005/06\" "
+                                  L"xmlns:x=\"http://schemas.microsoft.com/xps/2005/06/resourcedictionary-key\">\n"
+                                  L"<VisualBrush x:Key=\"%s\" ViewboxUnits=\"Absolute\" Viewbox=\"0,0,%.2f,%.2f\" "
+                                  L"ViewportUnits=\"Absolute\" Viewport=\"0,0,%.2f,%.2f\">\n"
+                                  L"<VisualBrush.Visual>\n<Canvas>\n",
+                                  bstrBrushKey,
+                                  markupDims.Width,
+                                  markupDims.Height,
+                                  markupDims.Width,
+                                  markupDims.Height);
+
+            cstrDictionary.Append(bstrContent);
+            cstrDictionary.Append(L"</Canvas>\n</VisualBrush.Visual>\n</VisualBrush>\n</ResourceDictionary>\n");
+
+            CWideToUTF8 wideToUTF8(&cstrDictionary);
+
+            PVOID pData = NULL;
+            ULONG cbData = 0;
+
+            if (SUCCEEDED(hr = wideToUTF8.GetBuffer(&pData, &cbData)))
+            {
+                ULONG cbWritten = 0;
+
+                hr = pStream->WriteBytes(pData, cbData, &cbWritten);
+
+                ASSERTMSG(cbData == cbWritten, "Failed to write all data.\n");
+            }
+        }
+        catch (CXDException& e)
+        {
+            hr = e;
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CWatermarkMarkup::GetKeyName
+
+Routine Description:
+
+    Method to obtain a unique key for the stored resource dictionary based on the resource name
+
+Arguments:
+
+    pbstrKeyName - Pointer to the string to contain the generated key name
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CWatermarkMarkup::GetKeyName(
+    _Outptr_ BSTR* pbstrKeyName
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(pbstrKeyName, E_POINTER)))
+    {
+        try
+        {
+            //
+            // The id of the resource is a suitable key
+            //
+            CStringXDW cstrKeyName;
+            cstrKeyName.Format(L"WMDict_%d", m_resourceID);
+
+            *pbstrKeyName = cstrKeyName.AllocSysString();
+        }
+        catch (CXDException& e)
+        {
+            hr = e;
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CWatermarkMarkup::GetResURI
+
+Routine Description:
+
+    Method to obtain the URI to the stored resource dictionary
+
+Arguments:
+
+    pbstrResURI - Pointer to the string to contain the resource dictionary URI
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CWatermarkMarkup::GetResURI(
+    _Outptr_ BSTR* pbstrResURI
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(pbstrResURI, E_POINTER)))
+    {
+        *pbstrResURI = NULL;
+
+        try
+        {
+            //
+            // Create a unique name for the watermark dictionary for this print session
+            //
+            CStringXDW cstrURI;
+            cstrURI.Format(L"/WM_%d_%u.dict", m_resourceID, GetUniqueNumber());
+
+            *pbstrResURI = cstrURI.AllocSysString();
+        }
+        catch (CXDException& e)
+        {
+            hr = e;
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
+
+/*++
+
+Routine Name:
+
+    CWatermarkMarkup::GetBrushKey
+
+Routine Description:
+
+    Method to obtain the key of the VisualBrush held in the resource dictionary
+
+Arguments:
+
+    pbstrBrushKey - Pointer to the string to contain the brush key
+
+Return Value:
+
+    HRESULT
+    S_OK - On success
+    E_*  - On error
+
+--*/
+HRESULT
+CWatermarkMarkup::GetBrushKey(
+    _Outptr_ BSTR* pbstrBrushKey
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (SUCCEEDED(hr = CHECK_POINTER(pbstrBrushKey, E_POINTER)))
+    {
+        try
+        {
+            CStringXDW cstrBrushKey;
+            cstrBrushKey.Format(L"WMBrush%d", m_resourceID);
+
+            *pbstrBrushKey = cstrBrushKey.AllocSysString();
+        }
+        catch (CXDException& e)
+        {
+            hr = e;
+        }
+    }
+
+    ERR_ON_HR(hr);
+    return hr;
+}
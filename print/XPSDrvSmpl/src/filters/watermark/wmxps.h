@@ -16,15 +16,18 @@ File Name:
 Abstract:
 
    Watermark XPS markup class definition. The CWatermarkMarkup class is responsible
-   for creating a stream that contains markup loaded from a resource.
+   for creating a stream that contains markup loaded from a resource. The class
+   also implements the IResWriter interface so that the markup can be added to the
+   resource cache as a remote resource dictionary shared by every page.
 
 --*/
 
 #pragma once
 
+#include "rescache.h"
 #include "wmptprop.h"
 
-class CWatermarkMarkup
+class CWatermarkMarkup : public IResWriter
 {
 public:
     CWatermarkMarkup(
@@ -44,6 +47,27 @@ public:
         _Out_ IStream** ppStream
         );
 
+    HRESULT
+    WriteData(
+        _In_ IPartBase*         pResource,
+        _In_ IPrintWriteStream* pStream
+        );
+
+    HRESULT
+    GetKeyName(
+        _Outptr_ BSTR* pbstrKeyName
+        );
+
+    HRESULT
+    GetResURI(
+        _Outptr_ BSTR* pbstrResURI
+        );
+
+    HRESULT
+    GetBrushKey(
+        _Outptr_ BSTR* pbstrBrushKey
+        );
+
 private:
     HRESULT
     CreateXPSStream(
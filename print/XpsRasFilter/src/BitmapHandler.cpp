@@ -128,7 +128,36 @@ TiffStreamBitmapHandler::ProcessBitmap(
     const IWICBitmap_t &bitmap
     )
 {
+    WriteEncodedBitmap(
+        EncodeBitmap(bitmap)
+        );
+}
 
+//
+//Routine Name:
+//
+//    TiffStreamBitmapHandler::EncodeBitmap
+//
+//Routine Description:
+//
+//    Encode the bitmap as a TIFF in memory. Only the
+//    (free-threaded) WIC factory is shared, so bands
+//    can be encoded on several threads at once.
+//
+//Arguments:
+//
+//    bitmap    - bitmap of a single band, to encode
+//
+//Return Value:
+//
+//    IStream_t (smart ptr)
+//    Stream holding the encoded TIFF, positioned at its end.
+//
+IStream_t
+TiffStreamBitmapHandler::EncodeBitmap(
+    const IWICBitmap_t &bitmap
+    )
+{
     //
     // Create an empty HGLOBAL to hold the encode cache
     //
@@ -138,17 +167,10 @@ TiffStreamBitmapHandler::ProcessBitmap(
 
     //
     // Create a stream to the encode buffer so that WIC can
-    // encode the TIFF in-memory
+    // encode the TIFF in-memory. The stream owns the HGLOBAL
+    // until the TIFF has been written out.
     //
-    IStream_t pIStream;
-
-    THROW_ON_FAILED_HRESULT(
-        ::CreateStreamOnHGlobal(
-            *pHG,
-            FALSE, // Do NOT Free the HGLOBAL on Release of the stream
-            &pIStream
-            )
-        );
+    IStream_t pIStream = pHG->ConvertToIStream();
 
     //
     // Create a WIC TIFF Encoder on the stream
@@ -249,6 +271,28 @@ TiffStreamBitmapHandler::ProcessBitmap(
         pWICEncoder->Commit()
         );
 
+    return pIStream;
+}
+
+//
+//Routine Name:
+//
+//    TiffStreamBitmapHandler::WriteEncodedBitmap
+//
+//Routine Description:
+//
+//    Stream a TIFF produced by EncodeBitmap out of the
+//    filter. Bands must be written in page order.
+//
+//Arguments:
+//
+//    pTiff     - stream holding the encoded TIFF
+//
+void
+TiffStreamBitmapHandler::WriteEncodedBitmap(
+    const IStream_t &pTiff
+    )
+{
     //
     // Get the size of the TIFF from the stream position
     //
@@ -257,7 +301,7 @@ TiffStreamBitmapHandler::ProcessBitmap(
     zero.QuadPart = 0;
 
     THROW_ON_FAILED_HRESULT(
-        pIStream->Seek(zero, SEEK_CUR, &tiffSize)
+        pTiff->Seek(zero, SEEK_CUR, &tiffSize)
         );
 
     ULONG cb;
@@ -278,8 +322,14 @@ TiffStreamBitmapHandler::ProcessBitmap(
         //
         // Get a pointer to the HGLOBAL memory
         //
-        HGlobalLock_t lock = pHG->Lock();
-        BYTE *pCache = lock->GetAddress();
+        HGLOBAL hG;
+
+        THROW_ON_FAILED_HRESULT(
+            ::GetHGlobalFromStream(pTiff, &hG)
+            );
+
+        HGlobalLock lock(hG);
+        BYTE *pCache = lock.GetAddress();
 
         //
         // Write the encoded Tiff to the output stream
@@ -36,6 +36,21 @@ public:
         const IWICBitmap_t &bitmap
         );
 
+    //
+    // EncodeBitmap may be called from several threads at once; the
+    // encoded Tiffs must then be written in band order with
+    // WriteEncodedBitmap from a single thread.
+    //
+    IStream_t
+    EncodeBitmap(
+        const IWICBitmap_t &bitmap
+        );
+
+    void
+    WriteEncodedBitmap(
+        const IStream_t &pTiff
+        );
+
     void
     WriteFooter();
 
@@ -31,6 +31,378 @@
 namespace xpsrasfilter
 {
 
+//
+// A single band of a page. The band is rasterized and encoded by one of
+// the band workers, then written out in order by RasterizePage.
+//
+struct PageBand
+{
+    INT         originY;
+    INT         height;
+    HRESULT     hr;
+    IStream_t   pTiff;
+    HANDLE      hMayStart;
+    HANDLE      hDone;
+};
+
+//
+// Rasterizes and encodes the bands of one page on several threads. Each
+// worker owns a rasterizer created on its own copy of the page, since
+// neither the Xps Object Model nor a rasterizer may be used by two
+// threads at once. Worker N handles bands N, N + workers, N + 2 * workers
+// and so on, so the bands complete roughly in the order they are written.
+//
+// A band may only start once the band a window's length before it has
+// been written, so a slow band cannot make the other workers pile up
+// encoded bands. Memory use is bounded by the window, not the page size.
+//
+class ParallelBandRasterizer
+{
+public:
+    ParallelBandRasterizer(
+        const IXpsRasterizationFactory_t    &pRasFactory,
+        TiffStreamBitmapHandler             *pBitmapHandler,
+        const RasterizationParameters       &rastParams,
+        FLOAT                               destDPI,
+        const FilterLiveness_t              &pLiveness
+        ) : m_pRasFactory(pRasFactory),
+            m_pBitmapHandler(pBitmapHandler),
+            m_rastParams(rastParams),
+            m_destDPI(destDPI),
+            m_pLiveness(pLiveness),
+            m_numWorkers(0),
+            m_bandWindow(0),
+            m_nextWorker(0),
+            m_isStopping(FALSE)
+    {
+        //
+        // Split the page into bands
+        //
+        INT bandOriginY = 0;
+
+        while (bandOriginY < m_rastParams.rasterHeight)
+        {
+            PageBand band;
+
+            band.originY = bandOriginY;
+            band.height = m_rastParams.bandHeight;
+            band.hr = S_OK;
+            band.hMayStart = NULL;
+            band.hDone = NULL;
+
+            if (bandOriginY + m_rastParams.bandHeight >= m_rastParams.rasterHeight)
+            {
+                band.height = m_rastParams.rasterHeight - bandOriginY;
+            }
+
+            m_bands.push_back(band);
+
+            bandOriginY += band.height;
+        }
+    }
+
+    ~ParallelBandRasterizer()
+    {
+        //
+        // Stop the workers after their current band and wait for them
+        // to exit before the bands and rasterizers go away
+        //
+        m_isStopping = TRUE;
+
+        for (size_t i = 0; i < m_bands.size(); i++)
+        {
+            if (m_bands[i].hMayStart)
+            {
+                ::SetEvent(m_bands[i].hMayStart);
+            }
+        }
+
+        if (!m_threads.empty())
+        {
+            ::WaitForMultipleObjects(
+                static_cast<DWORD>(m_threads.size()),
+                &m_threads[0],
+                TRUE,
+                INFINITE
+                );
+        }
+
+        for (size_t i = 0; i < m_threads.size(); i++)
+        {
+            ::CloseHandle(m_threads[i]);
+        }
+
+        for (size_t i = 0; i < m_bands.size(); i++)
+        {
+            if (m_bands[i].hMayStart)
+            {
+                ::CloseHandle(m_bands[i].hMayStart);
+            }
+
+            if (m_bands[i].hDone)
+            {
+                ::CloseHandle(m_bands[i].hDone);
+            }
+        }
+    }
+
+    void
+    Start(
+        const IXpsOMPage_t  &pPage,
+        UINT                numWorkers
+        )
+    {
+        m_bandWindow = numWorkers * ms_bandWindowPerWorker;
+
+        for (size_t i = 0; i < m_bands.size(); i++)
+        {
+            //
+            // The first window of bands may start straight away
+            //
+            m_bands[i].hMayStart = ::CreateEvent(NULL, TRUE, (i < m_bandWindow), NULL);
+
+            if (!m_bands[i].hMayStart)
+            {
+                THROW_LAST_ERROR();
+            }
+
+            m_bands[i].hDone = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+
+            if (!m_bands[i].hDone)
+            {
+                THROW_LAST_ERROR();
+            }
+        }
+
+        //
+        // Create every rasterizer before starting any worker, so that a
+        // failure here cannot leave bands that no worker will complete
+        //
+        for (UINT i = 0; i < numWorkers; i++)
+        {
+            IXpsOMPage_t pWorkerPage(pPage);
+
+            if (i > 0)
+            {
+                pWorkerPage.Release();
+
+                THROW_ON_FAILED_HRESULT(
+                    pPage->Clone(&pWorkerPage)
+                    );
+            }
+
+            IXpsRasterizer_t rasterizer;
+            THROW_ON_FAILED_HRESULT(
+                m_pRasFactory->CreateRasterizer(
+                                    pWorkerPage,
+                                    m_rastParams.rasterizationDPI,
+                                    XPSRAS_RENDERING_MODE_ANTIALIASED,
+                                    XPSRAS_RENDERING_MODE_ANTIALIASED,
+                                    &rasterizer
+                                    )
+                );
+
+            THROW_ON_FAILED_HRESULT(
+                rasterizer->SetMinimalLineWidth(1)
+                );
+
+            m_pages.push_back(pWorkerPage);
+            m_rasterizers.push_back(rasterizer);
+        }
+
+        m_numWorkers = numWorkers;
+
+        m_threads.reserve(numWorkers);
+
+        for (UINT i = 0; i < numWorkers; i++)
+        {
+            HANDLE hThread = ::CreateThread(
+                                    NULL,
+                                    0,
+                                    WorkerThreadProc,
+                                    this,
+                                    0,
+                                    NULL
+                                    );
+
+            if (!hThread)
+            {
+                THROW_LAST_ERROR();
+            }
+
+            m_threads.push_back(hThread);
+        }
+    }
+
+    //
+    // Write the bands out in page order as they complete. Returns
+    // FALSE if rasterization was cancelled.
+    //
+    BOOL
+    WriteBands()
+    {
+        for (size_t i = 0; i < m_bands.size(); i++)
+        {
+            if (::WaitForSingleObject(m_bands[i].hDone, INFINITE) != WAIT_OBJECT_0)
+            {
+                THROW_LAST_ERROR();
+            }
+
+            if (m_bands[i].hr == HRESULT_FROM_WIN32(ERROR_PRINT_CANCELLED))
+            {
+                return FALSE;
+            }
+
+            THROW_ON_FAILED_HRESULT(m_bands[i].hr);
+
+            m_pBitmapHandler->WriteEncodedBitmap(m_bands[i].pTiff);
+
+            //
+            // Free the encoded band as soon as it has been written, and
+            // let the band one window further on start
+            //
+            m_bands[i].pTiff.Release();
+
+            if (i + m_bandWindow < m_bands.size())
+            {
+                ::SetEvent(m_bands[i + m_bandWindow].hMayStart);
+            }
+        }
+
+        return TRUE;
+    }
+
+private:
+    static
+    DWORD WINAPI
+    WorkerThreadProc(
+        LPVOID pContext
+        )
+    {
+        ParallelBandRasterizer *pThis = static_cast<ParallelBandRasterizer *>(pContext);
+
+        pThis->RunWorker(
+            static_cast<UINT>(::InterlockedIncrement(&pThis->m_nextWorker) - 1)
+            );
+
+        return 0;
+    }
+
+    void
+    RunWorker(
+        UINT worker
+        )
+    {
+        HRESULT hr = S_OK;
+        size_t  bandIndex = worker;
+
+        try
+        {
+            //
+            // The rasterizers and the WIC factory were created in the
+            // multithreaded apartment; join it for the life of the worker.
+            //
+            SafeCoInit coInit;
+
+            for (; bandIndex < m_bands.size(); bandIndex += m_numWorkers)
+            {
+                RasterizeBand(m_rasterizers[worker], m_bands[bandIndex]);
+
+                ::SetEvent(m_bands[bandIndex].hDone);
+            }
+        }
+        CATCH_VARIOUS(hr);
+
+        //
+        // Fail the bands this worker did not complete so that the
+        // writer does not wait for them
+        //
+        for (; bandIndex < m_bands.size(); bandIndex += m_numWorkers)
+        {
+            m_bands[bandIndex].hr = hr;
+
+            ::SetEvent(m_bands[bandIndex].hDone);
+        }
+    }
+
+    void
+    RasterizeBand(
+        const IXpsRasterizer_t  &rasterizer,
+        PageBand                &band
+        )
+    {
+        if (::WaitForSingleObject(band.hMayStart, INFINITE) != WAIT_OBJECT_0)
+        {
+            THROW_LAST_ERROR();
+        }
+
+        DoTraceMessage(XPSRASFILTER_TRACE_VERBOSE, L"Rasterizing Band");
+
+        if (m_isStopping ||
+            !m_pLiveness->IsAlive())
+        {
+            throw hr_error(HRESULT_FROM_WIN32(ERROR_PRINT_CANCELLED));
+        }
+
+        IWICBitmap_t bitmap;
+
+        HRESULT hr = rasterizer->RasterizeRect(
+                        m_rastParams.originX,
+                        band.originY + m_rastParams.originY,
+                        m_rastParams.rasterWidth,
+                        band.height,
+                        static_cast<IXpsRasterizerNotificationCallback *>(m_pLiveness),
+                        &bitmap
+                        );
+
+        //
+        // Do not trace if we have cancelled rasterization
+        //
+        if (hr == HRESULT_FROM_WIN32(ERROR_PRINT_CANCELLED))
+        {
+            throw hr_error(hr);
+        }
+
+        THROW_ON_FAILED_HRESULT(hr);
+
+        THROW_ON_FAILED_HRESULT(
+            bitmap->SetResolution(
+                m_destDPI,
+                m_destDPI
+                )
+            );
+
+        band.pTiff = m_pBitmapHandler->EncodeBitmap(bitmap);
+    }
+
+    //
+    // prevent copy semantics
+    //
+    ParallelBandRasterizer(const ParallelBandRasterizer&);
+    ParallelBandRasterizer& operator=(const ParallelBandRasterizer&);
+
+    IXpsRasterizationFactory_t              m_pRasFactory;
+    TiffStreamBitmapHandler                 *m_pBitmapHandler;
+    const RasterizationParameters           &m_rastParams;
+    FLOAT                                   m_destDPI;
+    FilterLiveness_t                        m_pLiveness;
+
+    std::vector<PageBand>                   m_bands;
+    std::vector<CAdapt<IXpsOMPage_t>>       m_pages;
+    std::vector<CAdapt<IXpsRasterizer_t>>   m_rasterizers;
+    std::vector<HANDLE>                     m_threads;
+
+    UINT                                    m_numWorkers;
+    size_t                                  m_bandWindow;
+    LONG                                    m_nextWorker;
+
+    //
+    // Number of bands each worker may run ahead of the writer
+    //
+    const static UINT ms_bandWindowPerWorker = 2;
+    volatile BOOL                           m_isStopping;
+};
+
 //
 //Routine Name:
 //
@@ -118,7 +490,9 @@ RasterizationInterface::RasterizationInterface(
         const IXpsRasterizationFactory_t    &pRasFactory,
         TiffStreamBitmapHandler_t           pBitmapHandler
         ) : m_pXPSRasFactory(pRasFactory), 
-            m_pBitmapHandler(pBitmapHandler)
+            m_pBitmapHandler(pBitmapHandler),
+            m_numPages(0),
+            m_rasterizationTicks(0)
 {
 }
 
@@ -140,6 +514,13 @@ void
 RasterizationInterface::FinishRasterization()
 {
     m_pBitmapHandler->WriteFooter();
+
+    if (m_rasterizationTicks > 0)
+    {
+        ULONGLONG pagesPerMinute = (m_numPages * 60 * 1000) / m_rasterizationTicks;
+
+        DoTraceMessage(XPSRASFILTER_TRACE_INFO, L"Rasterized %I64u pages in %I64u ms (%I64u pages/min)", m_numPages, m_rasterizationTicks, pagesPerMinute);
+    }
 }
 
 
@@ -153,7 +534,9 @@ RasterizationInterface::FinishRasterization()
 //    Given an IXpsOMPage and a set of Print Ticket
 //    parameters, this method invokes the Xps Rasterization
 //    Service for each band of the page, and outputs the
-//    resultant raster data.
+//    resultant raster data. Bands are rasterized and
+//    encoded on several threads when more than one
+//    processor is available, and written out in order.
 //
 //Arguments:
 //
@@ -186,6 +569,118 @@ RasterizationInterface::RasterizePage(
         fixedPageParams
         );
 
+    ULONGLONG startTicks = ::GetTickCount64();
+
+    INT numBands = (rastParams.rasterHeight + rastParams.bandHeight - 1) / rastParams.bandHeight;
+    UINT numWorkers = GetBandWorkerCount(numBands);
+
+    if (numWorkers > 1)
+    {
+        ParallelBandRasterizer parallelRasterizer(
+                                    m_pXPSRasFactory,
+                                    m_pBitmapHandler.get(),
+                                    rastParams,
+                                    printTicketParams.destDPI,
+                                    pLiveness
+                                    );
+
+        parallelRasterizer.Start(pPage, numWorkers);
+
+        if (!parallelRasterizer.WriteBands())
+        {
+            DoTraceMessage(XPSRASFILTER_TRACE_VERBOSE, L"Rasterization Cancelled");
+            return;
+        }
+    }
+    else
+    {
+        RasterizeBands(
+            pPage,
+            rastParams,
+            printTicketParams.destDPI,
+            pLiveness
+            );
+    }
+
+    m_numPages++;
+    m_rasterizationTicks += ::GetTickCount64() - startTicks;
+}
+
+//
+//Routine Name:
+//
+//    RasterizationInterface::GetBandWorkerCount
+//
+//Routine Description:
+//
+//    Determine how many threads should rasterize the bands
+//    of a page. Bands are only rasterized in parallel when
+//    the Xps Rasterization Service objects were created in
+//    the multithreaded apartment, since they are then free
+//    to be called from the worker threads.
+//
+//Arguments:
+//
+//    numBands    - number of bands in the page
+//
+//Return Value:
+//
+//    UINT
+//    The number of band workers; 1 to rasterize on this thread.
+//
+UINT
+RasterizationInterface::GetBandWorkerCount(
+    INT numBands
+    )
+{
+    APTTYPE             aptType;
+    APTTYPEQUALIFIER    aptQualifier;
+
+    if (FAILED(::CoGetApartmentType(&aptType, &aptQualifier)) ||
+        aptType != APTTYPE_MTA)
+    {
+        return 1;
+    }
+
+    SYSTEM_INFO systemInfo;
+    ::GetSystemInfo(&systemInfo);
+
+    UINT numWorkers = min(systemInfo.dwNumberOfProcessors, ms_maxBandWorkers);
+
+    if (numBands < static_cast<INT>(numWorkers))
+    {
+        numWorkers = static_cast<UINT>(max(numBands, 1));
+    }
+
+    return numWorkers;
+}
+
+//
+//Routine Name:
+//
+//    RasterizationInterface::RasterizeBands
+//
+//Routine Description:
+//
+//    Invoke the Xps Rasterization Service for each band
+//    of the page in turn on the calling thread, and output
+//    the resultant raster data.
+//
+//Arguments:
+//
+//    pPage           - page to rasterize
+//    rastParams      - rasterization parameters for the page
+//    destDPI         - resolution of the output bitmaps
+//    pLiveness       - filter liveness and rasterizer callback
+//
+void
+RasterizationInterface::RasterizeBands(
+    const IXpsOMPage_t              &pPage,
+    const RasterizationParameters   &rastParams,
+    FLOAT                           destDPI,
+    const FilterLiveness_t          &pLiveness
+    )
+{
     //
     // Create the Rasterizer
     //
@@ -262,8 +757,8 @@ RasterizationInterface::RasterizePage(
         //
         THROW_ON_FAILED_HRESULT(
             bitmap->SetResolution(
-                printTicketParams.destDPI,
-                printTicketParams.destDPI
+                destDPI,
+                destDPI
                 )
             );
 
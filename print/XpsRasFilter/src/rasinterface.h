@@ -21,6 +21,8 @@
 namespace xpsrasfilter
 {
 
+struct RasterizationParameters;
+
 class RasterizationInterface
 {
 public:
@@ -51,6 +53,12 @@ public:
     //
     const static LONG ms_targetBandSize = 1024 * 1024 * 16;
 
+    //
+    // Maximum number of threads rasterizing the bands of a page. Each
+    // one holds a band bitmap of up to ms_targetBandSize while it works.
+    //
+    const static UINT ms_maxBandWorkers = 4;
+
 private:
 
     //
@@ -68,6 +76,19 @@ private:
     RasterizationInterface(const RasterizationInterface&);
     RasterizationInterface& operator=(const RasterizationInterface&);
 
+    UINT
+    GetBandWorkerCount(
+        INT numBands
+        );
+
+    void
+    RasterizeBands(
+        const IXpsOMPage_t              &pPage,
+        const RasterizationParameters   &rastParams,
+        FLOAT                           destDPI,
+        const FilterLiveness_t          &pLiveness
+        );
+
     //
     // Internal data members
     //
@@ -81,6 +102,12 @@ private:
     // Bitmap Handler
     //
     TiffStreamBitmapHandler_t m_pBitmapHandler;
+
+    //
+    // Throughput statistics, reported when rasterization finishes
+    //
+    ULONGLONG m_numPages;
+    ULONGLONG m_rasterizationTicks;
 };
 
 //
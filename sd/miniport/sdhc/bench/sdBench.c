@@ -0,0 +1,327 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All Rights Reserved
+
+Module Name:
+
+    sdBench.c
+
+Abstract:
+
+    A sequential read throughput benchmark for cards behind sdhc.
+
+    On a host that supports it, sdhc bounds multi-block transfers to UHS-I
+    and HS200/HS400 cards with an Auto CMD23 ahead of the command, instead
+    of ending them with an Auto CMD12.  Setting the DisableAutoCmd23 value
+    of its Parameters key turns that off.  The value is read when the
+    driver loads, so the benchmark runs with whatever setting sdhc was
+    loaded with and prints it; compare a run with the value at 0 and a run
+    with it at 1, restarting the controller in between.
+
+    There is no SD emulator to run against, so the benchmark reads from a
+    real card.  It issues one unbuffered read at a time, sequentially over
+    the start of the disk, for each of a range of transfer lengths.  The
+    stop command costs the same for every transfer, so its share shows at
+    the shorter multi-block lengths; single block reads end without one
+    either way and give a baseline.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_code_)
+
+#include <windows.h>
+#include <winioctl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define DEFAULT_MILLISECONDS    2000
+
+//
+//  Reads stay within the start of the disk, so that the card's mapping
+//  of it is the same from run to run.
+//
+
+#define READ_WINDOW             (64 * 1024 * 1024)
+
+#define SDHC_PARAMETERS_KEY     L"SYSTEM\\CurrentControlSet\\Services\\sdhc\\Parameters"
+#define SDHC_AUTO_CMD23_VALUE   L"DisableAutoCmd23"
+
+//
+//  A single block, which is never stopped, then multi-block lengths from
+//  a page to the largest transfer sdport usually sends.
+//
+
+const ULONG Lengths[] = { 512, 4096, 16384, 65536, 262144, 1024 * 1024 };
+
+LARGE_INTEGER Frequency;
+
+
+HANDLE
+OpenDisk (
+    _In_ ULONG DiskNumber
+    )
+{
+    WCHAR Name[32];
+
+    swprintf_s( Name, ARRAYSIZE( Name ), L"\\\\.\\PhysicalDrive%u", DiskNumber );
+
+    return CreateFileW( Name,
+                        GENERIC_READ,
+                        FILE_SHARE_READ | FILE_SHARE_WRITE,
+                        NULL,
+                        OPEN_EXISTING,
+                        FILE_FLAG_NO_BUFFERING,
+                        NULL );
+}
+
+
+BOOLEAN
+TimeReads (
+    _In_ HANDLE Disk,
+    _In_ ULONG Length,
+    _In_ ULONGLONG Window,
+    _Out_writes_bytes_(Length) PUCHAR Buffer,
+    _In_ ULONG Milliseconds,
+    _Out_ PULONGLONG Reads,
+    _Out_ double *Seconds
+    )
+
+/*++
+
+Routine Description:
+
+    Reads the window sequentially, Length bytes at a time and starting
+    over at its beginning, until Milliseconds have passed.
+
+--*/
+
+{
+    LARGE_INTEGER Start;
+    LARGE_INTEGER Now;
+    LARGE_INTEGER Offset;
+    LONGLONG Budget;
+    DWORD Bytes;
+    ULONG i;
+
+    *Reads = 0;
+    *Seconds = 0.0;
+
+    Offset.QuadPart = 0;
+
+    //
+    //  Warm up the card and the request path.
+    //
+
+    for (i = 0; i < 16; i++) {
+
+        if (!SetFilePointerEx( Disk, Offset, NULL, FILE_BEGIN ) ||
+            !ReadFile( Disk, Buffer, Length, &Bytes, NULL ) ||
+            (Bytes != Length)) {
+
+            return FALSE;
+        }
+    }
+
+    Budget = Frequency.QuadPart * Milliseconds / 1000;
+
+    QueryPerformanceCounter( &Start );
+
+    do {
+
+        for (i = 0; i < 16; i++) {
+
+            if (!SetFilePointerEx( Disk, Offset, NULL, FILE_BEGIN ) ||
+                !ReadFile( Disk, Buffer, Length, &Bytes, NULL ) ||
+                (Bytes != Length)) {
+
+                return FALSE;
+            }
+
+            Offset.QuadPart += Length;
+
+            if ((ULONGLONG)Offset.QuadPart + Length > Window) {
+
+                Offset.QuadPart = 0;
+            }
+        }
+
+        *Reads += 16;
+
+        QueryPerformanceCounter( &Now );
+
+    } while (Now.QuadPart - Start.QuadPart < Budget);
+
+    *Seconds = (double)(Now.QuadPart - Start.QuadPart) / (double)Frequency.QuadPart;
+
+    return TRUE;
+}
+
+
+PCSTR
+AutoCmd23Setting (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    Returns how DisableAutoCmd23 was set, for the report.  It is only read
+    by sdhc when the driver loads, and Auto CMD23 is only used when the
+    host and the card's bus speed allow it.
+
+--*/
+
+{
+    DWORD Value = 0;
+    DWORD Size = sizeof( Value );
+
+    if ((RegGetValueW( HKEY_LOCAL_MACHINE,
+                       SDHC_PARAMETERS_KEY,
+                       SDHC_AUTO_CMD23_VALUE,
+                       RRF_RT_REG_DWORD,
+                       NULL,
+                       &Value,
+                       &Size ) == ERROR_SUCCESS) && (Value != 0)) {
+
+        return "off (DisableAutoCmd23 = 1)";
+    }
+
+    return "on where the host and card support it";
+}
+
+
+VOID
+Usage (
+    VOID
+    )
+{
+    printf( "Usage: sdBench [-Milliseconds <n>] <disk number>\n" );
+    printf( "    -Milliseconds   time spent on each length (default %d)\n", DEFAULT_MILLISECONDS );
+    printf( "    The disk number is that of \\\\.\\PhysicalDrive<n>.  Only reads are issued.\n" );
+}
+
+
+int
+__cdecl
+main (
+    _In_ int argc,
+    _In_reads_(argc) char *argv[]
+    )
+{
+    ULONG Milliseconds = DEFAULT_MILLISECONDS;
+    ULONG DiskNumber = MAXULONG;
+    GET_LENGTH_INFORMATION LengthInfo;
+    ULONGLONG Window;
+    HANDLE Disk;
+    PUCHAR Buffer;
+    DWORD Bytes;
+    ULONGLONG Reads;
+    double Seconds;
+    double PerRead;
+    int Argument;
+    int Failures = 0;
+    ULONG l;
+
+    for (Argument = 1; Argument < argc; Argument++) {
+
+        if ((_stricmp( argv[Argument], "-Milliseconds" ) == 0) && (Argument + 1 < argc)) {
+
+            Milliseconds = strtoul( argv[++Argument], NULL, 0 );
+
+        } else if ((argv[Argument][0] >= '0') && (argv[Argument][0] <= '9') && (DiskNumber == MAXULONG)) {
+
+            DiskNumber = strtoul( argv[Argument], NULL, 0 );
+
+        } else {
+
+            Usage();
+            return 1;
+        }
+    }
+
+    if ((Milliseconds == 0) || (DiskNumber == MAXULONG)) {
+
+        Usage();
+        return 1;
+    }
+
+    Disk = OpenDisk( DiskNumber );
+
+    if (Disk == INVALID_HANDLE_VALUE) {
+
+        printf( "Could not open PhysicalDrive%u, error %u\n", DiskNumber, GetLastError() );
+        return 1;
+    }
+
+    if (!DeviceIoControl( Disk, IOCTL_DISK_GET_LENGTH_INFO, NULL, 0, &LengthInfo, sizeof( LengthInfo ), &Bytes, NULL ) ||
+        (LengthInfo.Length.QuadPart < Lengths[ARRAYSIZE( Lengths ) - 1])) {
+
+        printf( "Could not get the length of PhysicalDrive%u, error %u\n", DiskNumber, GetLastError() );
+        CloseHandle( Disk );
+        return 1;
+    }
+
+    Window = min( (ULONGLONG)LengthInfo.Length.QuadPart, READ_WINDOW );
+
+    Buffer = VirtualAlloc( NULL, Lengths[ARRAYSIZE( Lengths ) - 1], MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE );
+
+    if (Buffer == NULL) {
+
+        printf( "Out of memory\n" );
+        CloseHandle( Disk );
+        return 1;
+    }
+
+    QueryPerformanceFrequency( &Frequency );
+
+    //
+    //  Keep the timing thread on one processor and ahead of the rest of
+    //  the system.
+    //
+
+    SetThreadAffinityMask( GetCurrentThread(), 1 );
+    SetThreadPriority( GetCurrentThread(), THREAD_PRIORITY_HIGHEST );
+
+    printf( "Auto CMD23: %s\n", AutoCmd23Setting() );
+    printf( "PhysicalDrive%u, sequential reads over the first %I64u MB, %u ms per length\n",
+            DiskNumber, Window / (1024 * 1024), Milliseconds );
+
+    printf( "%8s %10s %10s %10s %12s\n",
+            "Length", "reads/s", "MB/s", "us/read", "us/512 byte" );
+
+    for (l = 0; l < ARRAYSIZE( Lengths ); l++) {
+
+        if (!TimeReads( Disk, Lengths[l], Window, Buffer, Milliseconds, &Reads, &Seconds )) {
+
+            printf( "%8u    read failed, error %u\n", Lengths[l], GetLastError() );
+            Failures++;
+            continue;
+        }
+
+        PerRead = Seconds * 1e6 / (double)Reads;
+
+        printf( "%8u %10.0f %10.1f %10.1f %12.2f\n",
+                Lengths[l],
+                (double)Reads / Seconds,
+                (double)Reads * Lengths[l] / Seconds / (1024.0 * 1024.0),
+                PerRead,
+                PerRead * 512.0 / Lengths[l] );
+    }
+
+    VirtualFree( Buffer, 0, MEM_RELEASE );
+    CloseHandle( Disk );
+
+    if (Failures != 0) {
+
+        printf( "\n%d lengths could not be read\n", Failures );
+        return 2;
+    }
+
+    return 0;
+}
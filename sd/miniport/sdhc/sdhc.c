@@ -31,8 +31,17 @@ Revision History:
 
 #ifdef ALLOC_PRAGMA
     #pragma alloc_text(INIT, DriverEntry)
+    #pragma alloc_text(INIT, SdhcQueryParameters)
 #endif
 
+//
+// Set from the DisableAutoCmd23 value of the service's Parameters key.
+// Multi-block transfers then always end with an Auto CMD12, so the two
+// ways of ending them can be compared on the same card.
+//
+
+BOOLEAN SdhcDisableAutoCmd23 = FALSE;
+
 //-----------------------------------------------------------------------------
 // SlotExtension routines.
 //-----------------------------------------------------------------------------
@@ -65,6 +74,8 @@ Return Value:
 
     SDPORT_INITIALIZATION_DATA InitializationData;
 
+    SdhcQueryParameters((PUNICODE_STRING)RegistryPath);
+
     RtlZeroMemory(&InitializationData, sizeof(InitializationData));
     InitializationData.StructureSize = sizeof(InitializationData);
 
@@ -101,6 +112,55 @@ Return Value:
     return SdPortInitialize(DriverObject, RegistryPath, &InitializationData);
 }
 
+VOID
+SdhcQueryParameters(
+    _In_ PUNICODE_STRING RegistryPath
+    )
+
+/*++
+
+Routine Description:
+
+    Read the miniport's settings from the Parameters key of the service.
+    A missing or malformed value leaves the default in place.
+
+Arguments:
+
+    RegistryPath - Registry path for this standard host controller.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    RTL_QUERY_REGISTRY_TABLE QueryTable[3];
+    ULONG DisableAutoCmd23 = 0;
+
+    RtlZeroMemory(QueryTable, sizeof(QueryTable));
+
+    QueryTable[0].Flags = RTL_QUERY_REGISTRY_SUBKEY;
+    QueryTable[0].Name = L"Parameters";
+
+    QueryTable[1].Flags = RTL_QUERY_REGISTRY_DIRECT |
+                          RTL_QUERY_REGISTRY_TYPECHECK;
+    QueryTable[1].Name = L"DisableAutoCmd23";
+    QueryTable[1].EntryContext = &DisableAutoCmd23;
+    QueryTable[1].DefaultType = (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) |
+                                REG_NONE;
+
+    if (NT_SUCCESS(RtlQueryRegistryValues(RTL_REGISTRY_ABSOLUTE,
+                                          RegistryPath->Buffer,
+                                          QueryTable,
+                                          NULL,
+                                          NULL))) {
+
+        SdhcDisableAutoCmd23 = (DisableAutoCmd23 != 0);
+    }
+}
+
 NTSTATUS
 SdhcGetSlotCount(
     _In_ PSD_MINIPORT Miniport,
@@ -713,6 +773,7 @@ Return value:
 
 {
 
+    ULONG FreeIndex;
     ULONG Index;
     PSDHC_EXTENSION SdhcExtension;
     NTSTATUS Status;
@@ -720,17 +781,31 @@ Return value:
     SdhcExtension = (PSDHC_EXTENSION) PrivateExtension;
 
     //
-    // Insert the request onto the outstanding requests list.
+    // Insert the request onto the outstanding requests list. A request that
+    // starts its data transfer after its command is already on the list, so
+    // it must not take a second entry.
     //
 
-    for (Index = 0;
-         Index < SdhcExtension->Capabilities.MaximumOutstandingRequests;
-         Index += 1) {
-
-        if (SdhcExtension->OutstandingRequests[Index] == NULL) {
-            SdhcExtension->OutstandingRequests[Index] = Request;
+    FreeIndex = SDHC_MAX_OUTSTANDING_REQUESTS;
+    for (Index = 0; Index < SDHC_MAX_OUTSTANDING_REQUESTS; Index += 1) {
+        if (SdhcExtension->OutstandingRequests[Index] == Request) {
             break;
         }
+
+        if ((SdhcExtension->OutstandingRequests[Index] == NULL) &&
+            (FreeIndex == SDHC_MAX_OUTSTANDING_REQUESTS)) {
+
+            FreeIndex = Index;
+        }
+    }
+
+    if (Index == SDHC_MAX_OUTSTANDING_REQUESTS) {
+        if (FreeIndex == SDHC_MAX_OUTSTANDING_REQUESTS) {
+            NT_ASSERT(FALSE);
+            return STATUS_DEVICE_BUSY;
+        }
+
+        SdhcExtension->OutstandingRequests[FreeIndex] = Request;
     }
 
     //
@@ -841,6 +916,8 @@ Return value:
         }
     }
 
+    NT_ASSERT(Index < SDHC_MAX_OUTSTANDING_REQUESTS);
+
     //
     // If there are errors, we need to fail whatever outstanding request
     // was on the bus. Otherwise, the request succeeded.
@@ -853,7 +930,10 @@ Return value:
 
     if (Errors) {
         Request->RequiredEvents = 0;
-        SdhcExtension->OutstandingRequests[Index] = NULL;
+        if (Index < SDHC_MAX_OUTSTANDING_REQUESTS) {
+            SdhcExtension->OutstandingRequests[Index] = NULL;
+        }
+
         Status = SdhcConvertErrorToStatus((USHORT) Errors);
         SdPortCompleteRequest(Request, Status);
 
@@ -862,7 +942,10 @@ Return value:
             Request->Status = STATUS_SUCCESS;
         }
 
-        SdhcExtension->OutstandingRequests[Index] = NULL;
+        if (Index < SDHC_MAX_OUTSTANDING_REQUESTS) {
+            SdhcExtension->OutstandingRequests[Index] = NULL;
+        }
+
         SdPortCompleteRequest(Request, Request->Status);
     }
 }
@@ -1449,6 +1532,10 @@ Return value:
         break;
     }
 
+    if (NT_SUCCESS(Status)) {
+        SdhcExtension->SpeedMode = SdhcGetSpeedMode(Speed);
+    }
+
     return Status;
 }
 
@@ -2541,20 +2628,30 @@ Return value:
         return STATUS_INVALID_PARAMETER;
     }
 
-    TransferMode &= ~(SDHC_TM_AUTO_CMD12_ENABLE |
-                      SDHC_TM_AUTO_CMD23_ENABLE |
-                      SDHC_TM_DMA_ENABLE |
-                      SDHC_TM_BLKCNT_ENABLE |
-                      SDHC_TM_MULTIBLOCK);
+    TransferMode = 0;
 
-    // if (Command->TransferType = TransferTypeMultiBlockNoStop) {
-
-    //}
+    //
+    // Multi-block transfers are bounded by the block count register. The
+    // card is told where the transfer ends either by a CMD23 that the host
+    // sends ahead of the command (Auto CMD23, with the count in the Argument
+    // 2 register), or by a CMD12 that the host sends after the last block.
+    // Auto CMD23 saves the stop command and lets the card stream the
+    // transfer without waiting for it. If the port driver has already set
+    // the block count itself, no stop command is needed.
+    //
 
     if (BlockCount > 1) {
         TransferMode |= SDHC_TM_MULTIBLOCK;
         TransferMode |= SDHC_TM_BLKCNT_ENABLE;
-        TransferMode |= SDHC_TM_AUTO_CMD12_ENABLE;
+        if (Request->Command.TransferType != SdTransferTypeMultiBlockNoStop) {
+            if (SdhcUseAutoCmd23(SdhcExtension)) {
+                TransferMode |= SDHC_TM_AUTO_CMD23_ENABLE;
+                SdhcWriteRegisterUlong(SdhcExtension, SDHC_SYSADDR, BlockCount);
+
+            } else {
+                TransferMode |= SDHC_TM_AUTO_CMD12_ENABLE;
+            }
+        }
     }
 
     if (Request->Command.TransferMethod == SdTransferMethodSgDma) {
@@ -2572,7 +2669,6 @@ Return value:
         TransferMode |= SDHC_TM_TRANSFER_READ;
     }
 
-    SdhcWriteRegisterUlong(SdhcExtension, SDHC_SYSADDR, BlockCount);
     SdhcWriteRegisterUshort(SdhcExtension, SDHC_BLOCK_SIZE, BlockSize);
     SdhcWriteRegisterUshort(SdhcExtension, SDHC_BLOCK_COUNT, BlockCount);
     SdhcWriteRegisterUshort(SdhcExtension, SDHC_TRANSFER_MODE, TransferMode);
@@ -1343,6 +1343,12 @@ typedef enum _SDHC_SPEED_MODE {
     SdhcSpeedModeHS400
 } SDHC_SPEED_MODE;
 
+//
+// sdport issues one command at a time to a standard host, so only one request
+// is ever outstanding. The request table below is kept correct for a larger
+// depth.
+//
+
 #define SDHC_MAX_OUTSTANDING_REQUESTS 1
 
 typedef struct _SDHC_EXTENSION {
@@ -1381,12 +1387,19 @@ typedef struct _SDHC_EXTENSION {
 
 #define SDHC_PCICFG_SLOT_INFORMATION    0x40
 
+extern BOOLEAN SdhcDisableAutoCmd23;
+
 NTSTATUS
 DriverEntry(
     _In_ PVOID DriverObject,
     _In_ PVOID RegistryPath
     );
 
+VOID
+SdhcQueryParameters(
+    _In_ PUNICODE_STRING RegistryPath
+    );
+
 //-----------------------------------------------------------------------------
 // SlotExtension callbacks.
 //-----------------------------------------------------------------------------
@@ -1816,6 +1829,111 @@ SdhcGetHwUhsMode(
     return 0;
 }
 
+__forceinline
+SDHC_SPEED_MODE
+SdhcGetSpeedMode(
+    _In_ SDPORT_BUS_SPEED BusSpeed
+    )
+
+/*++
+
+Routine Description:
+
+    Return the speed mode the slot is in after switching to the given bus
+    speed.
+
+Arguments:
+
+    BusSpeed - Bus speed selected by the port driver.
+
+Return value:
+
+    Speed mode for the bus speed.
+
+--*/
+
+{
+
+    switch (BusSpeed) {
+    case SdBusSpeedHigh:
+    case SdBusSpeedSDR25:
+        return SdhcSpeedModeHigh;
+
+    case SdBusSpeedSDR50:
+        return SdhcSpeedModeSDR50;
+
+    case SdBusSpeedDDR50:
+        return SdhcSpeedModeDDR50;
+
+    case SdBusSpeedSDR104:
+        return SdhcSpeedModeSDR104;
+
+    case SdBusSpeedHS200:
+        return SdhcSpeedModeHS200;
+
+    case SdBusSpeedHS400:
+        return SdhcSpeedModeHS400;
+
+    case SdBusSpeedNormal:
+    case SdBusSpeedSDR12:
+    default:
+        break;
+    }
+
+    return SdhcSpeedModeNormal;
+}
+
+__forceinline
+BOOLEAN
+SdhcUseAutoCmd23(
+    _In_ PSDHC_EXTENSION SdhcExtension
+    )
+
+/*++
+
+Routine Description:
+
+    Determine whether multi-block transfers should be bounded by an Auto
+    CMD23 issued by the host instead of stopped with an Auto CMD12.
+
+    The host must support Auto CMD23, and the card must support CMD23. The
+    miniport doesn't see the card's SCR, so CMD23 support is inferred from
+    the bus speed: UHS-I cards running SDR50, DDR50 or SDR104 and eMMC
+    devices in HS200 or HS400 are required to support it. The
+    DisableAutoCmd23 registry value turns it off.
+
+Arguments:
+
+    SdhcExtension - Host controller specific driver context.
+
+Return value:
+
+    TRUE if Auto CMD23 should be used.
+
+--*/
+
+{
+
+    if ((SdhcDisableAutoCmd23 != FALSE) ||
+        (SdhcExtension->Capabilities.Supported.AutoCmd23 == 0)) {
+        return FALSE;
+    }
+
+    switch (SdhcExtension->SpeedMode) {
+    case SdhcSpeedModeSDR50:
+    case SdhcSpeedModeDDR50:
+    case SdhcSpeedModeSDR104:
+    case SdhcSpeedModeHS200:
+    case SdhcSpeedModeHS400:
+        return TRUE;
+
+    default:
+        break;
+    }
+
+    return FALSE;
+}
+
 __forceinline
 USHORT
 SdhcConvertEventsToHwMask(
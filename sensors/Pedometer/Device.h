@@ -26,7 +26,8 @@
 #define Pedometer_Default_Power_Milliwatts    (2.0f) // milli watts
 #define Pedometer_TimeoutForHistoryThread_Ms  (1000) // milli seconds
 #define Pedometer_Default_HistoryInterval_Ms  (60000) // 1 minute in milli seconds
-#define Pedometer_Default_MaxHistoryEntries   (60) // max of 60 history entries
+#define Pedometer_Default_MaxHistoryEntries   (24 * 60) // max of 24 hours of history entries
+#define Pedometer_HistoryTimerTolerance_Ms    (10000) // history timer may be coalesced by up to 10 seconds
 
 // Sensor Common Properties
 typedef enum
@@ -93,7 +93,7 @@ private:
     _Requires_lock_held_(m_HistoryLock)
     NTSTATUS AddDataElemToHistoryBuffer(_In_ PPedometerSample pData);
     _Requires_lock_held_(m_HistoryLock)
-    NTSTATUS RemoveDataElemFromHistoryBuffer(_Out_ PPedometerSample pData);
+    NTSTATUS RemoveDataElemsFromHistoryBuffer(_Inout_ PULONG SamplesCount, _Out_writes_to_(*SamplesCount, *SamplesCount) PPedometerSample pData);
 
 } HardwareSimulator, *PHardwareSimulator;
 
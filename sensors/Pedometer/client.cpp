@@ -703,7 +703,9 @@ PedometerDevice::HistoryRetrievalThread(
     }
 
     // Get the number of elements that can actually fit into the provided client buffer.
+    // The HW never holds more than its history size, so there is no need to allocate beyond that.
     FillableCount = (pDevice->m_ClientHistoryBufferSize - SENSOR_COLLECTION_LIST_HEADER_SIZE) / (pDevice->m_HistoryMarshalledRecordSize - SENSOR_COLLECTION_LIST_HEADER_SIZE);
+    FillableCount = min(FillableCount, pSimulator->GetHistorySizeInRecords());
 
     // Allocate enough memory to read the samples from HW
     MemoryHandle = NULL;
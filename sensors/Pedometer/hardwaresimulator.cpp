@@ -186,8 +186,11 @@ HardwareSimulator::InitializeInternal(
             goto Exit;
         }
 
-        // Create timer object for keeping history
+        // Create timer object for keeping history. History entries are only read back in bulk,
+        // so the timer does not need to fire on time and the system is allowed to coalesce it
+        // with other wake ups.
         WDF_TIMER_CONFIG_INIT(&TimerConfig, HardwareSimulator::OnHistoryTimerExpire);
+        TimerConfig.TolerableDelay = Pedometer_HistoryTimerTolerance_Ms;
         WDF_OBJECT_ATTRIBUTES_INIT(&TimerAttributes);
         TimerAttributes.ParentObject = SimulatorInstance;
         TimerAttributes.ExecutionLevel = WdfExecutionLevelPassive;
@@ -414,34 +417,47 @@ HardwareSimulator::Reset()
 }
 
 
-// This routine is called by history retrieval thread to remove an entry from the history buffer.
+// This routine is called by history retrieval thread to remove up to 'SamplesCount' of the oldest
+// entries from the history buffer. The entries are copied as at most two contiguous runs (before
+// and after the wrap point of the circular buffer).
 // Note this function must be called under lock
 _Requires_lock_held_(m_HistoryLock)
 NTSTATUS
-HardwareSimulator::RemoveDataElemFromHistoryBuffer(
-    _Out_ PPedometerSample pData // Pedometer data removed from the buffer
+HardwareSimulator::RemoveDataElemsFromHistoryBuffer(
+    _Inout_ PULONG SamplesCount, // In: capacity of pData, Out: number of entries removed
+    _Out_writes_to_(*SamplesCount, *SamplesCount) PPedometerSample pData // Pedometer data removed from the buffer
     )
 {
     NTSTATUS Status = STATUS_SUCCESS;
+    ULONG SamplesToCopy = min(*SamplesCount, m_History.NumOfElems);
+    ULONG SamplesCopied = 0;
 
     if (0 == m_History.NumOfElems)
     {
         // buffer empty
         Status = STATUS_NO_MORE_ENTRIES;
     }
-    else
+
+    while (SamplesToCopy > SamplesCopied)
     {
-        *pData = m_History.pData[m_History.FirstElemIndex];
-        m_History.FirstElemIndex++;
+        ULONG RunLength = min(SamplesToCopy - SamplesCopied, m_History.BufferLength - m_History.FirstElemIndex);
+
+        memcpy(&pData[SamplesCopied], &m_History.pData[m_History.FirstElemIndex], RunLength * sizeof(PedometerSample));
+
+        SamplesCopied += RunLength;
+        m_History.FirstElemIndex += RunLength;
         m_History.FirstElemIndex %= m_History.BufferLength;
-        m_History.NumOfElems--;
-        if (0 == m_History.NumOfElems)
-        {
-            // Buffer Empty. 'LastElemIndex' should be same as 'FirstElemIndex'
-            m_History.LastElemIndex = m_History.FirstElemIndex;
-        }
+        m_History.NumOfElems -= RunLength;
+    }
+
+    if (0 == m_History.NumOfElems)
+    {
+        // Buffer Empty. 'LastElemIndex' should be same as 'FirstElemIndex'
+        m_History.LastElemIndex = m_History.FirstElemIndex;
     }
 
+    *SamplesCount = SamplesCopied;
+
     return Status;
 }
 
@@ -608,6 +624,8 @@ HardwareSimulator::ClearHistory()
 // Once read, those samples will be removed from the History.
 // All read samples will be removed from the History buffer
 // Any unread samples will continue to persist int the History buffer
+// The samples are removed in a single pass under the history lock, so retrieving hours of
+// history costs one lock acquisition rather than one per sample.
 NTSTATUS 
 HardwareSimulator::ReadHistory(
     _Inout_ PULONG SamplesCount,
@@ -624,42 +642,19 @@ HardwareSimulator::ReadHistory(
         goto Exit;
     }
 
-    while (*SamplesCount > SamplesCopied)
+    // Check whether the Cancel event is signaled before retrieving the entries from the history buffer.
+    if (WAIT_OBJECT_0 == WaitForSingleObjectEx(m_HistoryCancelReadEvt, 0, FALSE))
     {
-        PedometerSample Data = {};
-
-        // Check whether the Cancel event is signaled before looping through each time to retrieve an entry from the history buffer.
-        if (WAIT_OBJECT_0 == WaitForSingleObjectEx(m_HistoryCancelReadEvt, 0, FALSE))
-        {
-            TraceError("PED %!FUNC! Read canceled");
-            Status = STATUS_CANCELLED;
-            break;
-        }
-
-        WdfWaitLockAcquire(m_HistoryLock, NULL);
-        Status = RemoveDataElemFromHistoryBuffer(&Data);
-        WdfWaitLockRelease(m_HistoryLock);
-
-        if (!NT_SUCCESS(Status))
-        {
-            break;
-        }
-
-        HistorySamplesBuffer[SamplesCopied++] = Data;
+        TraceError("PED %!FUNC! Read canceled");
+        Status = STATUS_CANCELLED;
+        goto Exit;
     }
 
-    if (STATUS_NO_MORE_ENTRIES == Status)
-    {
-        // Ignore STATUS_NO_MORE_ENTRIES if there were any entries that were copied
-        if (0 < SamplesCopied)
-        {
-            Status = STATUS_SUCCESS;
-        }
-    } 
-    else if (*SamplesCount < SamplesCopied)
-    {
-        Status = STATUS_BUFFER_OVERFLOW;
-    }
+    SamplesCopied = *SamplesCount;
+
+    WdfWaitLockAcquire(m_HistoryLock, NULL);
+    Status = RemoveDataElemsFromHistoryBuffer(&SamplesCopied, HistorySamplesBuffer);
+    WdfWaitLockRelease(m_HistoryLock);
 
 Exit:
     *SamplesCount = SamplesCopied;
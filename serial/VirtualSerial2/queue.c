@@ -31,6 +31,8 @@ QueueCreate(
     WDF_OBJECT_ATTRIBUTES   queueAttributes;
     WDFQUEUE                queue;
     PQUEUE_CONTEXT          queueContext;
+    WDF_TIMER_CONFIG        timerConfig;
+    WDF_OBJECT_ATTRIBUTES   timerAttributes;
 
     //
     // Create the default queue
@@ -41,7 +43,6 @@ QueueCreate(
                             WdfIoQueueDispatchParallel);
 
     queueConfig.EvtIoRead           = EvtIoRead;
-    queueConfig.EvtIoWrite          = EvtIoWrite;
     queueConfig.EvtIoDeviceControl  = EvtIoDeviceControl;
 
     WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(
@@ -64,6 +65,43 @@ QueueCreate(
     queueContext->Queue = queue;
     queueContext->DeviceContext = DeviceContext;
 
+    //
+    // Create a sequential queue for write requests. The write callback is
+    // the only producer of the ring buffer, and dispatching writes one at a
+    // time is what lets it write to the ring buffer without a lock
+    //
+
+    WDF_IO_QUEUE_CONFIG_INIT(
+                            &queueConfig,
+                            WdfIoQueueDispatchSequential);
+
+    queueConfig.EvtIoWrite          = EvtIoWrite;
+
+    status = WdfIoQueueCreate(
+                            device,
+                            &queueConfig,
+                            WDF_NO_OBJECT_ATTRIBUTES,
+                            &queue);
+
+    if( !NT_SUCCESS(status) ) {
+        Trace(TRACE_LEVEL_ERROR,
+            "Error: WdfIoQueueCreate write queue failed 0x%x", status);
+        return status;
+    }
+
+    status = WdfDeviceConfigureRequestDispatching(
+                            device,
+                            queue,
+                            WdfRequestTypeWrite);
+
+    if( !NT_SUCCESS(status) ) {
+        Trace(TRACE_LEVEL_ERROR,
+            "Error: WdfDeviceConfigureRequestDispatching failed 0x%x", status);
+        return status;
+    }
+
+    queueContext->WriteQueue = queue;
+
     //
     // Create a manual queue to hold pending read requests. By keeping
     // them in the queue, framework takes care of cancelling them if the app
@@ -74,6 +112,8 @@ QueueCreate(
                             &queueConfig,
                             WdfIoQueueDispatchManual);
 
+    queueConfig.EvtIoCanceledOnQueue = EvtIoReadCanceledOnQueue;
+
     status = WdfIoQueueCreate(
                             device,
                             &queueConfig,
@@ -88,6 +128,30 @@ QueueCreate(
 
     queueContext->ReadQueue = queue;
 
+    //
+    // Create the timer that completes pending reads whose timeouts expire
+    //
+
+    WDF_TIMER_CONFIG_INIT(
+                            &timerConfig,
+                            EvtReadTimer);
+
+    timerConfig.AutomaticSerialization = FALSE;
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&timerAttributes);
+    timerAttributes.ParentObject = queueContext->Queue;
+
+    status = WdfTimerCreate(
+                            &timerConfig,
+                            &timerAttributes,
+                            &queueContext->ReadTimer);
+
+    if( !NT_SUCCESS(status) ) {
+        Trace(TRACE_LEVEL_ERROR,
+            "Error: WdfTimerCreate failed 0x%x", status);
+        return status;
+    }
+
     //
     // Create another manual queue to hold pending IOCTL_SERIAL_WAIT_ON_MASK
     //
@@ -297,6 +361,8 @@ EvtIoDeviceControl(
     {
         SERIAL_TIMEOUTS timeoutValues = {0};
 
+        GetTimeouts(deviceContext, &timeoutValues);
+
         status = RequestCopyFromBuffer(Request,
                             (void*) &timeoutValues,
                             sizeof(timeoutValues));
@@ -438,10 +504,15 @@ EvtIoWrite(
     )
 {
     NTSTATUS                status;
-    PQUEUE_CONTEXT          queueContext = GetQueueContext(Queue);
+    PQUEUE_CONTEXT          queueContext;
     WDFMEMORY               memory;
-    WDFREQUEST              savedRequest;
-    size_t                  availableData = 0;
+
+    //
+    // Writes come from the sequential write queue, the ring buffer and the
+    // pending reads belong to the default queue
+    //
+    queueContext = GetQueueContext(
+                            WdfDeviceGetDefaultQueue(WdfIoQueueGetDevice(Queue)));
 
     Trace(TRACE_LEVEL_INFO,
             "EvtIoWrite 0x%p", Request);
@@ -450,6 +521,7 @@ EvtIoWrite(
     if( !NT_SUCCESS(status) ) {
         Trace(TRACE_LEVEL_ERROR,
             "Error: WdfRequestRetrieveInputMemory failed 0x%x", status);
+        WdfRequestComplete(Request, status);
         return;
     }
 
@@ -461,45 +533,16 @@ EvtIoWrite(
                             (PUCHAR)WdfMemoryGetBuffer(memory, NULL),
                             Length);
     if( !NT_SUCCESS(status) ) {
+        WdfRequestComplete(Request, status);
         return;
     }
 
     WdfRequestCompleteWithInformation(Request, status, Length);
 
     //
-    // Get the amount of data available in the ring buffer
-    //
-    RingBufferGetAvailableData(
-                            &queueContext->RingBuffer,
-                            &availableData);
-
-    if (availableData == 0) {
-        return;
-    }
-
-    //
-    // Continue with the next request, if there is one pending
+    // Complete the pending reads that the new data satisfies
     //
-    for ( ; ; ) {
-
-        status = WdfIoQueueRetrieveNextRequest(
-                            queueContext->ReadQueue,
-                            &savedRequest);
-
-        if (!NT_SUCCESS(status)) {
-            break;
-        }
-
-        status = WdfRequestForwardToIoQueue(
-                            savedRequest,
-                            Queue);
-
-        if( !NT_SUCCESS(status) ) {
-            Trace(TRACE_LEVEL_ERROR,
-                "Error: WdfRequestForwardToIoQueue failed 0x%x", status);
-            WdfRequestComplete(savedRequest, status);
-        }
-    }
+    QueueServiceReads(queueContext);
 }
 
 
@@ -512,51 +555,324 @@ EvtIoRead(
 {
     NTSTATUS                status;
     PQUEUE_CONTEXT          queueContext = GetQueueContext(Queue);
-    WDFMEMORY               memory;
-    size_t                  bytesCopied = 0;
+    WDF_OBJECT_ATTRIBUTES   attributes;
+    PREAD_CONTEXT           readContext;
 
     Trace(TRACE_LEVEL_INFO,
             "EvtIoRead 0x%p", Request);
 
-    status = WdfRequestRetrieveOutputMemory(Request, &memory);
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(
+                            &attributes,
+                            READ_CONTEXT);
+
+    status = WdfObjectAllocateContext(Request,
+                            &attributes,
+                            (PVOID*)&readContext);
     if( !NT_SUCCESS(status) ) {
         Trace(TRACE_LEVEL_ERROR,
-            "Error: WdfRequestRetrieveOutputMemory failed 0x%x", status);
+            "Error: WdfObjectAllocateContext failed 0x%x", status);
         WdfRequestComplete(Request, status);
         return;
     }
 
-    status = RingBufferRead(&queueContext->RingBuffer,
-                            (BYTE*)WdfMemoryGetBuffer(memory, NULL),
-                            Length,
-                            &bytesCopied);
+    QueueInitializeRead(queueContext, readContext, Length);
+
+    //
+    // Reads are always completed from the read queue, in order, so a read
+    // cannot overtake one that is still waiting for data
+    //
+    status = WdfRequestForwardToIoQueue(Request,
+                            queueContext->ReadQueue);
     if( !NT_SUCCESS(status) ) {
+        Trace(TRACE_LEVEL_ERROR,
+            "Error: WdfRequestForwardToIoQueue failed 0x%x", status);
         WdfRequestComplete(Request, status);
         return;
     }
 
-    if (bytesCopied > 0) {
+    QueueServiceReads(queueContext);
+}
+
+
+VOID
+EvtIoReadCanceledOnQueue(
+    _In_  WDFQUEUE          Queue,
+    _In_  WDFREQUEST        Request
+    )
+{
+    PREAD_CONTEXT           readContext = GetReadContext(Request);
+
+    UNREFERENCED_PARAMETER(Queue);
+
+    //
+    // The bytes already copied into the request were taken out of the ring
+    // buffer, so report them rather than dropping them
+    //
+    WdfRequestCompleteWithInformation(Request,
+                            STATUS_CANCELLED,
+                            readContext->BytesCopied);
+}
+
+
+VOID
+EvtReadTimer(
+    _In_  WDFTIMER          Timer
+    )
+{
+    QueueServiceReads(GetQueueContext(WdfTimerGetParentObject(Timer)));
+}
+
+
+VOID
+QueueInitializeRead(
+    _In_  PQUEUE_CONTEXT    QueueContext,
+    _In_  PREAD_CONTEXT     ReadContext,
+    _In_  size_t            Length
+    )
+/*++
+Routine Description:
+
+    Works out when a new read is complete from the current serial
+    timeouts, the way SetCommTimeouts() documents them.
+
+Arguments:
+
+    ReadContext - The context of the new read request.
+
+    Length - Length of the read. The framework does not dispatch zero
+             length reads to the driver.
+--*/
+{
+    SERIAL_TIMEOUTS         timeouts;
+    ULONGLONG               now = QueueGetTickCount();
+    ULONGLONG               totalTimeout;
+
+    GetTimeouts(QueueContext->DeviceContext, &timeouts);
+
+    RtlZeroMemory(ReadContext, sizeof(*ReadContext));
+    ReadContext->Length = Length;
+
+    if ((timeouts.ReadIntervalTimeout == MAXULONG) &&
+        (timeouts.ReadTotalTimeoutMultiplier == 0) &&
+        (timeouts.ReadTotalTimeoutConstant == 0))
+    {
         //
-        // Data was read from buffer succesfully
+        // Return immediately with whatever is buffered, even nothing
         //
-        WdfRequestCompleteWithInformation(Request, status, bytesCopied);
+        ReadContext->Immediate = TRUE;
         return;
     }
-    else {
+
+    if ((timeouts.ReadIntervalTimeout == MAXULONG) &&
+        (timeouts.ReadTotalTimeoutMultiplier == MAXULONG) &&
+        (timeouts.ReadTotalTimeoutConstant != 0) &&
+        (timeouts.ReadTotalTimeoutConstant != MAXULONG))
+    {
         //
-        // No data to read. Queue the request for later processing.
+        // Return as soon as there is any data, or after the constant
         //
-        status = WdfRequestForwardToIoQueue(Request,
-                            queueContext->ReadQueue);
+        ReadContext->ReturnOnAnyData = TRUE;
+        ReadContext->TotalDeadline = now + timeouts.ReadTotalTimeoutConstant;
+        return;
+    }
+
+    totalTimeout = (ULONGLONG)timeouts.ReadTotalTimeoutMultiplier * Length +
+                   timeouts.ReadTotalTimeoutConstant;
+    if (totalTimeout != 0) {
+        ReadContext->TotalDeadline = now + totalTimeout;
+    }
+
+    if (timeouts.ReadIntervalTimeout != MAXULONG) {
+        ReadContext->IntervalTimeout = timeouts.ReadIntervalTimeout;
+    }
+}
+
+
+VOID
+QueueServiceReads(
+    _In_  PQUEUE_CONTEXT    QueueContext
+    )
+/*++
+Routine Description:
+
+    Completes the pending reads that can be completed. Called when a read
+    arrives, when data is written, and when the read timer fires.
+
+    The pass that completes reads is the single consumer of the ring
+    buffer, so only one pass runs at a time. A call made while a pass is
+    running does not wait for it. It only makes the running pass go once
+    more, and calls that pile up meanwhile share that one extra pass.
+--*/
+{
+    if (InterlockedIncrement(&QueueContext->ReadServiceCount) != 1) {
+        return;
+    }
+
+    for ( ; ; ) {
+
+        QueueCompleteReads(QueueContext);
+
+        if (InterlockedCompareExchange(&QueueContext->ReadServiceCount, 0, 1) == 1) {
+            break;
+        }
+
+        InterlockedExchange(&QueueContext->ReadServiceCount, 1);
+    }
+}
+
+
+VOID
+QueueCompleteReads(
+    _In_  PQUEUE_CONTEXT    QueueContext
+    )
+/*++
+Routine Description:
+
+    Copies buffered data into the pending reads in order, and completes
+    each one that is full or timed out. Stops at the first read that has to
+    wait for more data, and arms the read timer for its next timeout.
+--*/
+{
+    NTSTATUS                status;
+    WDFREQUEST              request;
+    WDFMEMORY               memory;
+    PREAD_CONTEXT           readContext;
+    size_t                  bytesCopied;
+    ULONGLONG               now = QueueGetTickCount();
+    ULONGLONG               due;
+
+    for ( ; ; ) {
+
+        status = WdfIoQueueRetrieveNextRequest(
+                            QueueContext->ReadQueue,
+                            &request);
+
+        if (!NT_SUCCESS(status)) {
+            break;
+        }
+
+        readContext = GetReadContext(request);
+
+        status = WdfRequestRetrieveOutputMemory(request, &memory);
         if( !NT_SUCCESS(status) ) {
             Trace(TRACE_LEVEL_ERROR,
-                "Error: WdfRequestForwardToIoQueue failed 0x%x", status);
-            WdfRequestComplete(Request, status);
+                "Error: WdfRequestRetrieveOutputMemory failed 0x%x", status);
+            WdfRequestCompleteWithInformation(request,
+                            status,
+                            readContext->BytesCopied);
+            continue;
+        }
+
+        bytesCopied = 0;
+
+        if (readContext->BytesCopied < readContext->Length) {
+            status = RingBufferRead(&QueueContext->RingBuffer,
+                            (BYTE*)WdfMemoryGetBuffer(memory, NULL) + readContext->BytesCopied,
+                            readContext->Length - readContext->BytesCopied,
+                            &bytesCopied);
+            if( !NT_SUCCESS(status) ) {
+                WdfRequestCompleteWithInformation(request,
+                            status,
+                            readContext->BytesCopied);
+                continue;
+            }
+        }
+
+        if (bytesCopied > 0) {
+            readContext->BytesCopied += bytesCopied;
+
+            if (readContext->IntervalTimeout != 0) {
+                readContext->IntervalDeadline = now + readContext->IntervalTimeout;
+            }
+        }
+
+        status = QueueGetReadStatus(readContext, now);
+
+        if (status != STATUS_PENDING) {
+            WdfRequestCompleteWithInformation(request,
+                            status,
+                            readContext->BytesCopied);
+            continue;
         }
+
+        //
+        // This read has to wait for more data. Put it back at the head of
+        // the read queue, where the framework can still cancel it
+        //
+        status = WdfRequestRequeue(request);
+        if( !NT_SUCCESS(status) ) {
+            Trace(TRACE_LEVEL_ERROR,
+                "Error: WdfRequestRequeue failed 0x%x", status);
+            WdfRequestCompleteWithInformation(request,
+                            status,
+                            readContext->BytesCopied);
+            continue;
+        }
+
+        due = readContext->TotalDeadline;
+        if ((readContext->IntervalDeadline != 0) &&
+            ((due == 0) || (readContext->IntervalDeadline < due))) {
+            due = readContext->IntervalDeadline;
+        }
+
+        if (due != 0) {
+            WdfTimerStart(QueueContext->ReadTimer,
+                            WDF_REL_TIMEOUT_IN_MS(due - now));
+        }
+        break;
     }
 }
 
 
+NTSTATUS
+QueueGetReadStatus(
+    _In_  PREAD_CONTEXT     ReadContext,
+    _In_  ULONGLONG         Now
+    )
+/*++
+Routine Description:
+
+    Returns the status to complete a read with, or STATUS_PENDING if it
+    has to wait for more data.
+--*/
+{
+    if (ReadContext->BytesCopied == ReadContext->Length) {
+        return STATUS_SUCCESS;
+    }
+
+    if (ReadContext->Immediate) {
+        return STATUS_SUCCESS;
+    }
+
+    if (ReadContext->ReturnOnAnyData && (ReadContext->BytesCopied != 0)) {
+        return STATUS_SUCCESS;
+    }
+
+    if ((ReadContext->TotalDeadline != 0) && (Now >= ReadContext->TotalDeadline)) {
+        return STATUS_TIMEOUT;
+    }
+
+    if ((ReadContext->IntervalDeadline != 0) && (Now >= ReadContext->IntervalDeadline)) {
+        return STATUS_TIMEOUT;
+    }
+
+    return STATUS_PENDING;
+}
+
+
+ULONGLONG
+QueueGetTickCount(
+    VOID
+    )
+{
+#ifdef _KERNEL_MODE
+    return KeQueryInterruptTime() / 10000;
+#else
+    return GetTickCount64();
+#endif
+}
+
+
 NTSTATUS
 QueueProcessWriteBytes(
     _In_  PQUEUE_CONTEXT    QueueContext,
@@ -572,7 +888,8 @@ Routine Description:
     It parses the Characters passed in and looks for the  for sequences "AT" -ok  ,
     "ATA" --CONNECT, ATD<number> -- CONNECT and sets the state of the device appropriately.
     These bytes are placed in the read Buffer to be processed later since this device
-    works in a loopback fashion.
+    works in a loopback fashion. Runs of bytes are copied into the read buffer
+    with one RingBufferWrite() each, rather than one byte at a time.
 
 Arguments:
 
@@ -591,6 +908,7 @@ Arguments:
     UCHAR                   connectStringCch = ARRAY_SIZE(connectString) - 1;
     UCHAR                   okString[]       = "\r\nOK\r\n";
     UCHAR                   okStringCch      = ARRAY_SIZE(okString) - 1;
+    PUCHAR                  runStart         = Characters;
 
     while (Length != 0) {
 
@@ -598,16 +916,19 @@ Arguments:
         Length--;
 
         if(currentCharacter == '\0') {
+            //
+            // NULs are not echoed. Write the run before this one
+            //
+            status = QueueWriteRun(QueueContext,
+                            runStart,
+                            (Characters - 1) - runStart);
+            if( !NT_SUCCESS(status) ) {
+                return status;
+            }
+            runStart = Characters;
             continue;
         }
 
-        status = RingBufferWrite(&QueueContext->RingBuffer,
-                            &currentCharacter,
-                            sizeof(currentCharacter));
-        if( !NT_SUCCESS(status) ) {
-            return status;
-        }
-
         switch (QueueContext->CommandMatchState) {
 
         case COMMAND_MATCH_STATE_IDLE:
@@ -660,6 +981,18 @@ Arguments:
                 //
                 QueueContext->CommandMatchState = COMMAND_MATCH_STATE_IDLE;
 
+                //
+                //  the command itself, up to and including the CR, comes
+                //  before the response
+                //
+                status = QueueWriteRun(QueueContext,
+                            runStart,
+                            Characters - runStart);
+                if( !NT_SUCCESS(status) ) {
+                    return status;
+                }
+                runStart = Characters;
+
                 if (QueueContext->ConnectCommand) {
                     //
                     //  place <cr><lf>CONNECT<cr><lf>  in the buffer
@@ -694,7 +1027,28 @@ Arguments:
             break;
         }
     }
-    return status;
+
+    return QueueWriteRun(QueueContext,
+                            runStart,
+                            Characters - runStart);
+}
+
+
+NTSTATUS
+QueueWriteRun(
+    _In_  PQUEUE_CONTEXT    QueueContext,
+    _In_reads_bytes_(Length)
+          PUCHAR            Characters,
+    _In_  size_t            Length
+    )
+{
+    if (Length == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    return RingBufferWrite(&QueueContext->RingBuffer,
+                            Characters,
+                            Length);
 }
 
 
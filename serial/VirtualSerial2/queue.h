@@ -21,7 +21,7 @@ Environment:
 #include "internal.h"
 
 // Set ring buffer size
-#define DATA_BUFFER_SIZE 1024
+#define DATA_BUFFER_SIZE 16384
 
 //
 // Device states
@@ -58,8 +58,16 @@ typedef struct _QUEUE_CONTEXT
 
     WDFQUEUE        Queue;              // Default parallel queue
 
+    WDFQUEUE        WriteQueue;         // Sequential queue for writes, the
+                                        // single producer of the ring buffer
+
     WDFQUEUE        ReadQueue;          // Manual queue for pending reads
 
+    WDFTIMER        ReadTimer;          // Fires at the next read timeout
+
+    volatile LONG   ReadServiceCount;   // QueueServiceReads() calls, one pass
+                                        // at a time consumes the ring buffer
+
     WDFQUEUE        WaitMaskQueue;      // Manual queue for pending ioctl wait-on-mask
 
     PDEVICE_CONTEXT DeviceContext;
@@ -68,9 +76,37 @@ typedef struct _QUEUE_CONTEXT
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(QUEUE_CONTEXT, GetQueueContext);
 
+//
+// Progress of a pending read. The deadlines are in milliseconds of
+// QueueGetTickCount(), and 0 when the timeout is not used.
+//
+typedef struct _READ_CONTEXT
+{
+    size_t          Length;
+
+    size_t          BytesCopied;
+
+    ULONGLONG       TotalDeadline;      // ReadTotalTimeoutMultiplier and
+                                        // ReadTotalTimeoutConstant
+
+    ULONG           IntervalTimeout;    // ReadIntervalTimeout
+
+    ULONGLONG       IntervalDeadline;   // IntervalTimeout after the last
+                                        // byte was copied
+
+    BOOLEAN         Immediate;          // Return what is buffered, if anything
+
+    BOOLEAN         ReturnOnAnyData;    // Return as soon as any byte arrives
+
+} READ_CONTEXT, *PREAD_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(READ_CONTEXT, GetReadContext);
+
 EVT_WDF_IO_QUEUE_IO_READ            EvtIoRead;
 EVT_WDF_IO_QUEUE_IO_WRITE           EvtIoWrite;
 EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL  EvtIoDeviceControl;
+EVT_WDF_IO_QUEUE_IO_CANCELED_ON_QUEUE EvtIoReadCanceledOnQueue;
+EVT_WDF_TIMER                       EvtReadTimer;
 
 NTSTATUS
 QueueCreate(
@@ -85,6 +121,42 @@ QueueProcessWriteBytes(
     _In_  size_t            Length
     );
 
+NTSTATUS
+QueueWriteRun(
+    _In_  PQUEUE_CONTEXT    QueueContext,
+    _In_reads_bytes_(Length)
+          PUCHAR            Characters,
+    _In_  size_t            Length
+    );
+
+VOID
+QueueInitializeRead(
+    _In_  PQUEUE_CONTEXT    QueueContext,
+    _In_  PREAD_CONTEXT     ReadContext,
+    _In_  size_t            Length
+    );
+
+VOID
+QueueServiceReads(
+    _In_  PQUEUE_CONTEXT    QueueContext
+    );
+
+VOID
+QueueCompleteReads(
+    _In_  PQUEUE_CONTEXT    QueueContext
+    );
+
+NTSTATUS
+QueueGetReadStatus(
+    _In_  PREAD_CONTEXT     ReadContext,
+    _In_  ULONGLONG         Now
+    );
+
+ULONGLONG
+QueueGetTickCount(
+    VOID
+    );
+
 NTSTATUS
 QueueProcessGetLineControl(
     _In_  PQUEUE_CONTEXT    QueueContext,
@@ -10,6 +10,13 @@ Abstract:
 
     This file implements the Ring Buffer
 
+    The ring has a single producer, the write callback, and a single
+    consumer, the routine that completes pending reads.  Neither takes a
+    lock.  Each side only ever moves its own pointer, and publishes it with
+    release semantics after the bytes it covers have been copied.  Each
+    side reads the other's pointer with acquire semantics before it touches
+    the bytes that pointer covers.
+
 Environment:
 
 --*/
@@ -38,16 +45,27 @@ RingBufferGetAvailableSpace(
     _Out_ size_t            *AvailableSpace
     )
 {
-    BYTE*                   headSnapshot = NULL;
-    BYTE*                   tailSnapshot = NULL;
-    BYTE*                   tailPlusOne  = NULL;
-
     ASSERT(AvailableSpace);
 
+    *AvailableSpace = RingBufferSpaceBetween(Self,
+                            RingBufferGetHead(Self),
+                            RingBufferGetTail(Self));
+}
+
+
+size_t
+RingBufferSpaceBetween(
+    _In_  PRING_BUFFER      Self,
+    _In_  BYTE*             HeadSnapshot,
+    _In_  BYTE*             TailSnapshot
+    )
+{
+    BYTE*                   tailPlusOne  = NULL;
+
     //
-    // Take a snapshot of the head and tail pointers. We will compute the
-    // available space based on this snapshot. This is safe to do in a
-    // single-producer, single-consumer model, because -
+    // The space is computed from a snapshot of the head and tail pointers.
+    // This is safe to do in a single-producer, single-consumer model,
+    // because -
     //     * A producer will call GetAvailableSpace() to determine whether
     //       there is enough space to write the data it is trying to write.
     //       The only other thread that could modify the amount of space
@@ -62,10 +80,6 @@ RingBufferGetAvailableSpace(
     //       space available (thereby increasing the amount of data
     //       available. Hence it is safe for the consumer to read based on
     //       this snapshot.
-    //
-    headSnapshot = Self->Head;
-    tailSnapshot = Self->Tail;
-
     //
     // In order to distinguish between a full buffer and an empty buffer,
     // we always leave the last byte of the buffer unused. So, an empty
@@ -74,16 +88,16 @@ RingBufferGetAvailableSpace(
     // ... and a full buffer is denoted by -
     //      (tail+1) == head
     //
-    tailPlusOne = ((tailSnapshot+1) == Self->End) ? Self->Base : (tailSnapshot+1);
+    tailPlusOne = ((TailSnapshot+1) == Self->End) ? Self->Base : (TailSnapshot+1);
 
-    if (tailPlusOne == headSnapshot)
+    if (tailPlusOne == HeadSnapshot)
     {
         //
         // Buffer full
         //
-        *AvailableSpace = 0;
+        return 0;
     }
-    else if (tailSnapshot == headSnapshot)
+    else if (TailSnapshot == HeadSnapshot)
     {
         //
         // Buffer empty
@@ -91,11 +105,11 @@ RingBufferGetAvailableSpace(
         // we always leave the last byte of the ring buffer unused in order
         // to distinguish between an empty buffer and a full buffer.
         //
-        *AvailableSpace = Self->Size - 1;
+        return Self->Size - 1;
     }
     else
     {
-        if (tailSnapshot > headSnapshot)
+        if (TailSnapshot > HeadSnapshot)
         {
             //
             // Data has not wrapped around the end of the buffer
@@ -104,7 +118,7 @@ RingBufferGetAvailableSpace(
             // in order to distinguish between an empty buffer and a full
             // buffer.
             //
-            *AvailableSpace = Self->Size - (tailSnapshot - headSnapshot) - 1;
+            return Self->Size - (TailSnapshot - HeadSnapshot) - 1;
         }
         else
         {
@@ -115,7 +129,7 @@ RingBufferGetAvailableSpace(
             // in order to distinguish between an empty buffer and a full
             // buffer.
             //
-            *AvailableSpace = (headSnapshot - tailSnapshot) - 1;
+            return (HeadSnapshot - TailSnapshot) - 1;
         }
     }
 }
@@ -153,18 +167,22 @@ RingBufferWrite(
     size_t                  availableSpace;
     size_t                  bytesToCopy;
     size_t                  spaceFromCurrToEnd;
+    BYTE*                   tail = Self->Tail;
 
     ASSERT(Data && (0 != DataSize));
 
-    if (Self->Tail >= Self->End)
+    if (tail >= Self->End)
     {
         return STATUS_INTERNAL_ERROR;
     }
 
     //
-    // Get the amount of space available in the buffer
+    // Get the amount of space available in the buffer. Only this thread
+    // moves the tail, so it is read without a barrier; the head is read
+    // with acquire semantics, so the consumer has finished copying out the
+    // bytes it gave back before we overwrite them.
     //
-    RingBufferGetAvailableSpace(Self, &availableSpace);
+    availableSpace = RingBufferSpaceBetween(Self, RingBufferGetHead(Self), tail);
 
     //
     // If there is not enough space to fit in all the data passed in by the
@@ -184,7 +202,7 @@ RingBufferWrite(
         //
         // The buffer has some space at least
         //
-        if ((Self->Tail + bytesToCopy) > Self->End)
+        if ((tail + bytesToCopy) > Self->End)
         {
             //
             // The data being written will wrap around the end of the buffer.
@@ -196,9 +214,9 @@ RingBufferWrite(
             //
             // The first step of the copy ...
             //
-            spaceFromCurrToEnd = Self->End - Self->Tail;
+            spaceFromCurrToEnd = Self->End - tail;
 
-            RtlCopyMemory(Self->Tail, Data, spaceFromCurrToEnd);
+            RtlCopyMemory(tail, Data, spaceFromCurrToEnd);
 
             Data += spaceFromCurrToEnd;
 
@@ -209,10 +227,7 @@ RingBufferWrite(
             //
             RtlCopyMemory(Self->Base, Data, bytesToCopy);
 
-            //
-            // Advance the tail pointer
-            //
-            Self->Tail = Self->Base + bytesToCopy;
+            tail = Self->Base + bytesToCopy;
         }
         else
         {
@@ -220,23 +235,26 @@ RingBufferWrite(
             // Data does NOT wrap around the end of the buffer. Just copy it
             // over in a single step
             //
-            RtlCopyMemory(Self->Tail, Data, bytesToCopy);
+            RtlCopyMemory(tail, Data, bytesToCopy);
 
-            //
-            // Advance the tail pointer
-            //
-            Self->Tail += bytesToCopy;
-            if (Self->Tail == Self->End)
+            tail += bytesToCopy;
+            if (tail == Self->End)
             {
                 //
                 // We have exactly reached the end of the buffer. The next
                 // write should wrap around and start from the beginning.
                 //
-                Self->Tail = Self->Base;
+                tail = Self->Base;
             }
         }
 
-        ASSERT(Self->Tail < Self->End);
+        ASSERT(tail < Self->End);
+
+        //
+        // Advance the tail pointer. The release makes the copied bytes
+        // visible to the consumer no later than the new tail.
+        //
+        RingBufferSetTail(Self, tail);
     }
 
     return STATUS_SUCCESS;
@@ -254,18 +272,22 @@ RingBufferRead(
 {
     size_t                  availableData;
     size_t                  dataFromCurrToEnd;
+    BYTE*                   head = Self->Head;
 
     ASSERT(Data && (DataSize != 0));
 
-    if (Self->Head >= Self->End)
+    if (head >= Self->End)
     {
         return STATUS_INTERNAL_ERROR;
     }
 
     //
-    // Get the amount of data available in the buffer
+    // Get the amount of data available in the buffer. Only this thread
+    // moves the head; the tail is read with acquire semantics, so the bytes
+    // the producer published are visible before we copy them.
     //
-    RingBufferGetAvailableData(Self, &availableData);
+    availableData = Self->Size -
+                    RingBufferSpaceBetween(Self, head, RingBufferGetTail(Self)) - 1;
 
     if (availableData == 0)
     {
@@ -280,7 +302,7 @@ RingBufferRead(
 
     *BytesCopied = DataSize;
 
-    if ((Self->Head + DataSize) > Self->End)
+    if ((head + DataSize) > Self->End)
     {
         //
         // The data requested by the caller is wrapped around the end of the
@@ -294,8 +316,8 @@ RingBufferRead(
         //
         // The first step of the copy ...
         //
-        dataFromCurrToEnd = Self->End - Self->Head;
-        RtlCopyMemory(Data, Self->Head, dataFromCurrToEnd);
+        dataFromCurrToEnd = Self->End - head;
+        RtlCopyMemory(Data, head, dataFromCurrToEnd);
         Data += dataFromCurrToEnd;
         DataSize -= dataFromCurrToEnd;
 
@@ -304,10 +326,7 @@ RingBufferRead(
         //
         RtlCopyMemory(Data, Self->Base, DataSize);
 
-        //
-        // Advance the head pointer
-        //
-        Self->Head = Self->Base + DataSize;
+        head = Self->Base + DataSize;
     }
     else
     {
@@ -315,23 +334,26 @@ RingBufferRead(
         // The data in the buffer is NOT wrapped around the end of the buffer.
         // Simply copy the data over to the caller's buffer in a single step.
         //
-        RtlCopyMemory(Data, Self->Head, DataSize);
+        RtlCopyMemory(Data, head, DataSize);
 
-        //
-        // Advance the head pointer
-        //
-        Self->Head += DataSize;
-        if (Self->Head == Self->End)
+        head += DataSize;
+        if (head == Self->End)
         {
             //
             // We have exactly reached the end of the buffer. The next
             // read should wrap around and start from the beginning.
             //
-            Self->Head = Self->Base;
+            head = Self->Base;
         }
     }
 
-    ASSERT(Self->Head < Self->End);
+    ASSERT(head < Self->End);
+
+    //
+    // Advance the head pointer. The release keeps the copy above from
+    // being reordered after the producer sees the space it frees.
+    //
+    RingBufferSetHead(Self, head);
 
     return STATUS_SUCCESS;
 }
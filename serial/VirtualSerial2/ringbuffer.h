@@ -31,53 +31,75 @@ typedef struct _RING_BUFFER
     //
     // A pointer to the current read point in the ring buffer.
     //
-    // Updates to this are not protected by any lock. This is different from
-    // the write pointer, which is protected by the "pending read pointer"
-    // lock. The reason for this difference is that in this driver, we do not
-    // keep write requests pending. If there is not enough space to write all
-    // the data that was requested, we write as much as we can and drop the
-    // rest (lossy data transfer).
+    // Updates to this are not protected by any lock. At any given time only
+    // one thread modifies this pointer, the one running QueueServiceReads(),
+    // which lets a single pass run at a time. The producer only reads it,
+    // through RingBufferGetHead().
     //
-    // If we had multiple threads modifying this pointer, then that would
-    // provide yet another reason for protecting updates to the pointer using a
-    // lock. However, in this driver, at any given time we have only one thread
-    // that modifies this pointer (the thread that runs the read callback).
-    // This is true because we use a sequential queue for read requests. If we
-    // were to change our read queue to be a parallel queue, this would no
-    // longer be true.
-    //
-    //
-    BYTE*           Head;
+    BYTE* volatile  Head;
 
     //
     // A pointer to the current write point in the ring buffer.
     //
-    // Updates to this pointer are protected by the "pending read pointer
-    // lock", because we do not want a consumer thread to mark a read request
-    // as pending while we are in the process of writing data to the buffer.
-    // The reason is that the write that we are currently performing might
-    // actually supply enough data to satisfy the read request, in which case
-    // it should not be marked pending at all.
-    // If the read request were to be marked pending in the situation described
-    // above, then we would need some trigger to later retrieve the request and
-    // complete it. In our driver, arrival of data is the only event that can
-    // trigger this. So if no more data arrives, the request will remain
-    // pending forever, even though there is enough data in the buffer to
-    // complete it. Hence we do not keep a read request pending in situations
-    // where the read buffer contains enough data to satisfy it.
+    // Updates to this are not protected by any lock either. At any given
+    // time only one thread modifies this pointer, the one running the write
+    // callback. This is true because write requests are dispatched from a
+    // sequential queue. If we were to change our write queue to be a
+    // parallel queue, this would no longer be true.
     //
-    // If we had multiple threads modifying this pointer, then that would
-    // provide yet another reason for protecting updates to the pointer using a
-    // lock. However, in this driver, at any given time we have only one thread
-    // that modifies this pointer (the thread that runs the write callback).
-    // This is true because we use a sequential queue for write requests. If we
-    // were to change our write queue to be a parallel queue, this would no
-    // longer be true.
+    // We do not keep write requests pending. If there is not enough space
+    // to write all the data that was requested, we write as much as we can
+    // and drop the rest (lossy data transfer). Once the write callback has
+    // advanced this pointer, it asks QueueServiceReads() to complete the
+    // pending reads that the new data satisfies.
     //
-    BYTE*           Tail;
+    BYTE* volatile  Tail;
 
 } RING_BUFFER, *PRING_BUFFER;
 
+//
+// The pointer the other side moves is read with acquire semantics, and a
+// side publishes its own pointer with release semantics, so the bytes a
+// pointer covers are always visible before the pointer itself.
+//
+FORCEINLINE
+BYTE*
+RingBufferGetHead(
+    _In_  PRING_BUFFER      Self
+    )
+{
+    return (BYTE*)ReadPointerAcquire((PVOID volatile *)&Self->Head);
+}
+
+FORCEINLINE
+BYTE*
+RingBufferGetTail(
+    _In_  PRING_BUFFER      Self
+    )
+{
+    return (BYTE*)ReadPointerAcquire((PVOID volatile *)&Self->Tail);
+}
+
+FORCEINLINE
+VOID
+RingBufferSetHead(
+    _In_  PRING_BUFFER      Self,
+    _In_  BYTE*             Head
+    )
+{
+    WritePointerRelease((PVOID volatile *)&Self->Head, Head);
+}
+
+FORCEINLINE
+VOID
+RingBufferSetTail(
+    _In_  PRING_BUFFER      Self,
+    _In_  BYTE*             Tail
+    )
+{
+    WritePointerRelease((PVOID volatile *)&Self->Tail, Tail);
+}
+
 
 VOID
 RingBufferInitialize(
@@ -115,3 +137,10 @@ RingBufferGetAvailableData(
     _In_  PRING_BUFFER      Self,
     _Out_ size_t            *AvailableData
     );
+
+size_t
+RingBufferSpaceBetween(
+    _In_  PRING_BUFFER      Self,
+    _In_  BYTE*             HeadSnapshot,
+    _In_  BYTE*             TailSnapshot
+    );
@@ -36,6 +36,8 @@ Notes:
 #pragma alloc_text(PAGESENM, Serenum_IoSyncIoctlEx)
 #pragma alloc_text(PAGESENM, Serenum_ReadSerialPort)
 #pragma alloc_text(PAGESENM, Serenum_Wait)
+#pragma alloc_text(PAGESENM, SerenumIdMatchesCache)
+#pragma alloc_text(PAGESENM, SerenumUpdateIdCache)
 #pragma alloc_text(PAGESENM, SerenumReleaseThreadReference)
 
 //#pragma alloc_text (PAGE, Serenum_GetRegistryKeyValue)
@@ -185,12 +187,41 @@ Return value:
 NTSTATUS
 SerenumDoEnumProtocol(
                                   PFDO_DEVICE_DATA PFdoData, 
+                                  ULONG FirstPass,
     _Outptr_result_buffer_(*PNBytes)  PUCHAR *PpBuf, 
                                   PUSHORT PNBytes,
-                                  PBOOLEAN PDSRMissing)
+                                  PBOOLEAN PDSRMissing,
+                                  PULONG PPass)
+/*++
+
+Routine Description:
+
+    Runs the PnP external COM device protocol on the port and returns
+    whatever the device sent back.
+
+    The protocol has two passes, one for modems and mice and one for other
+    devices.  FirstPass selects which one is tried first; when the ID cache
+    says the device answered on the second pass, trying that pass first
+    saves the modem pass's extra wait and read timeout.
+
+Arguments:
+
+    PFdoData    - pointer to the FDO's device-specific data
+    FirstPass   - the pass to try first (0 = modem)
+    PpBuf       - returns the buffer of data read from the port
+    PNBytes     - returns the number of bytes in *PpBuf
+    PDSRMissing - returns TRUE if DSR was not set
+    PPass       - returns the pass the data was read on
+
+Return value:
+
+    NTSTATUS
+
+--*/
 {
    IO_STATUS_BLOCK ioStatusBlock;
    ULONG i;
+   ULONG pass;
    ULONG bitMask;
    KEVENT event;
    KTIMER timer;
@@ -226,6 +257,7 @@ SerenumDoEnumProtocol(
    pReadBuf = NULL;
    nRead = 0;
    *PDSRMissing = FALSE;
+   *PPass = 0;
 
    LOGENTRY(LOG_ENUM, 'SDEP', PFdoData,  PpBuf, PDSRMissing);
 
@@ -266,14 +298,53 @@ SerenumDoEnumProtocol(
    }
 
    //
-   // Wait for the default timeout period
+   // Start the default timeout period.  The line settings only affect our
+   // side of the link, so they are made while the timer runs rather than
+   // after it.
    //
 
 #if defined(PERFCNT)
    stPerfCnt = KeQueryPerformanceCounter(&perfFreq);
 #endif
 
-   status = Serenum_Wait(&timer, DefaultWait);
+   KeSetTimer(&timer, DefaultWait, NULL);
+
+   //
+   // Setup the serial port for 1200 bits/s, 7 data bits,
+   // no parity, one stop bit
+   //
+   Serenum_KdPrint(PFdoData, SER_DBG_SS_TRACE, ("Setting baud rate to 1200..."
+                                               "\n"));
+   baudRate.BaudRate = 1200;
+   status = Serenum_IoSyncIoctlEx(IOCTL_SERIAL_SET_BAUD_RATE, FALSE, pDevStack,
+                                  &event, &baudRate, sizeof(SERIAL_BAUD_RATE),
+                                  NULL, 0);
+   if (!NT_SUCCESS(status)) {
+      LOGENTRY(LOG_ENUM, 'SDE6', PFdoData,  status, 0);
+      goto ProtocolDone;
+   }
+
+   Serenum_KdPrint(PFdoData, SER_DBG_SS_TRACE,
+                   ("Setting the line control...\n"));
+
+   lineControl.StopBits = STOP_BIT_1;
+   lineControl.Parity = NO_PARITY;
+   lineControl.WordLength = 7;
+
+   status = Serenum_IoSyncIoctlEx(IOCTL_SERIAL_SET_LINE_CONTROL, FALSE,
+                                  pDevStack, &event, &lineControl,
+                                  sizeof(SERIAL_LINE_CONTROL), NULL, 0);
+
+   if (!NT_SUCCESS(status)) {
+      LOGENTRY(LOG_ENUM, 'SDE7', PFdoData,  status, 0);
+      goto ProtocolDone;
+   }
+
+   //
+   // Wait out the rest of the default timeout period
+   //
+
+   status = KeWaitForSingleObject(&timer, Executive, KernelMode, FALSE, NULL);
 
 #if defined(PERFCNT)
    endPerfCnt = KeQueryPerformanceCounter(NULL);
@@ -314,50 +385,22 @@ SerenumDoEnumProtocol(
       LOGENTRY(LOG_ENUM, 'SDND', PFdoData,  0, 0);
    }
 
-   //
-   // Setup the serial port for 1200 bits/s, 7 data bits,
-   // no parity, one stop bit
-   //
-   Serenum_KdPrint(PFdoData, SER_DBG_SS_TRACE, ("Setting baud rate to 1200..."
-                                               "\n"));
-   baudRate.BaudRate = 1200;
-   status = Serenum_IoSyncIoctlEx(IOCTL_SERIAL_SET_BAUD_RATE, FALSE, pDevStack,
-                                  &event, &baudRate, sizeof(SERIAL_BAUD_RATE),
-                                  NULL, 0);
-   if (!NT_SUCCESS(status)) {
-      LOGENTRY(LOG_ENUM, 'SDE6', PFdoData,  status, 0);
-      goto ProtocolDone;
-   }
-
-   Serenum_KdPrint(PFdoData, SER_DBG_SS_TRACE,
-                   ("Setting the line control...\n"));
-
-   lineControl.StopBits = STOP_BIT_1;
-   lineControl.Parity = NO_PARITY;
-   lineControl.WordLength = 7;
-
-   status = Serenum_IoSyncIoctlEx(IOCTL_SERIAL_SET_LINE_CONTROL, FALSE,
-                                  pDevStack, &event, &lineControl,
-                                  sizeof(SERIAL_LINE_CONTROL), NULL, 0);
-
-   if (!NT_SUCCESS(status)) {
-      LOGENTRY(LOG_ENUM, 'SDE7', PFdoData,  status, 0);
-      goto ProtocolDone;
-   }
-
 
    //
    // loop twice
-   // The first iteration is for reading the PNP ID string from modems
-   // and mice.
-   // The second iteration is for other devices.
+   // Pass 0 is for reading the PNP ID string from modems and mice.
+   // Pass 1 is for other devices.
+   // FirstPass picks which one goes first.
    //
    for (i = 0; i < 2; i++) {
+      pass = (FirstPass + i) & 1;
+      *PPass = pass;
+
       //
       // Purge the buffers before reading
       //
 
-      LOGENTRY(LOG_ENUM, 'SDEI', PFdoData,  i, 0);
+      LOGENTRY(LOG_ENUM, 'SDEI', PFdoData,  pass, 0);
 
       Serenum_KdPrint(PFdoData, SER_DBG_SS_TRACE, ("Purging all buffers...\n"));
 
@@ -441,11 +484,11 @@ SerenumDoEnumProtocol(
 #endif
 
       //
-      // First iteration is for modems
+      // Pass 0 is for modems
       // Therefore wait for 200 ms as per protocol for getting PNP string out
       //
 
-      if (!i) {
+      if (!pass) {
          status = Serenum_Wait(&timer, DefaultWait);
          if (!NT_SUCCESS(status)) {
             Serenum_KdPrint (PFdoData, SER_DBG_SS_ERROR,
@@ -534,6 +577,13 @@ SerenumDoEnumProtocol(
 
 ProtocolDone:;
 
+   //
+   // The timer lives on our stack; make sure it isn't left set if we bailed
+   // out while it was running.
+   //
+
+   KeCancelTimer(&timer);
+
    if (!NT_SUCCESS(status)) {
       if (pReadBuf != NULL) {
          ExFreePoolWithTag(pReadBuf,SERENUM_POOL_TAG);
@@ -702,6 +752,131 @@ Return value:
    return rval;
 }
 
+BOOLEAN
+SerenumIdMatchesCache(IN PFDO_DEVICE_DATA PFdoData,
+     _In_reads_(NBytes) IN PUCHAR PBuf,
+                        IN USHORT NBytes,
+                        IN BOOLEAN DSRMissing)
+/*++
+
+Routine Description:
+
+   Checks whether the port sent back the same bytes as the last time a
+   device was identified on it.
+
+Arguments:
+
+    PFdoData   - pointer to the FDO's device-specific data
+    PBuf       - Buffer of data returned from device
+    NBytes     - length of PBuf in bytes
+    DSRMissing - TRUE if DSR was not set
+
+Return value:
+
+    BOOLEAN -- TRUE if it is the cached device, FALSE otherwise
+
+--*/
+{
+   PSERENUM_ID_CACHE pCache = &PFdoData->IdCache;
+
+   PAGED_CODE();
+
+   return (BOOLEAN)(pCache->State == SERENUM_IDCACHE_DEVICE
+                    && pCache->Length == NBytes
+                    && pCache->DSRMissing == (ULONG)DSRMissing
+                    && RtlEqualMemory(pCache->Id, PBuf, NBytes));
+}
+
+VOID
+SerenumUpdateIdCache(IN PFDO_DEVICE_DATA PFdoData, IN ULONG State,
+                     IN ULONG Pass,
+  _In_reads_opt_(NBytes) IN PUCHAR PBuf,
+                     IN USHORT NBytes,
+                     IN BOOLEAN DSRMissing)
+/*++
+
+Routine Description:
+
+   Records what this enumeration found on the port and, if that differs
+   from what was recorded before, saves it in the port's device key.
+
+Arguments:
+
+    PFdoData   - pointer to the FDO's device-specific data
+    State      - SERENUM_IDCACHE_XXX
+    Pass       - protocol pass the device answered on
+    PBuf       - Buffer of data returned from device, if any
+    NBytes     - length of PBuf in bytes
+    DSRMissing - TRUE if DSR was not set
+
+Return value:
+
+    none
+
+--*/
+{
+   PSERENUM_ID_CACHE pCache = &PFdoData->IdCache;
+   UNICODE_STRING valueName;
+   HANDLE keyHandle;
+   NTSTATUS status;
+
+   PAGED_CODE();
+
+   if (State != SERENUM_IDCACHE_DEVICE || PBuf == NULL
+       || NBytes > MAX_DEVNODE_NAME) {
+      Pass = 0;
+      NBytes = 0;
+      DSRMissing = FALSE;
+   }
+
+   if (State == SERENUM_IDCACHE_DEVICE && NBytes == 0) {
+      State = SERENUM_IDCACHE_NONE;
+   }
+
+   if (pCache->State == State && pCache->Pass == Pass
+       && pCache->DSRMissing == (ULONG)DSRMissing
+       && pCache->Length == NBytes
+       && (NBytes == 0 || RtlEqualMemory(pCache->Id, PBuf, NBytes))) {
+      return;
+   }
+
+   RtlZeroMemory(pCache, sizeof(*pCache));
+   pCache->State = State;
+   pCache->Pass = Pass;
+   pCache->DSRMissing = DSRMissing;
+   pCache->Length = NBytes;
+
+   if (NBytes != 0) {
+      RtlCopyMemory(pCache->Id, PBuf, NBytes);
+   }
+
+   //
+   // Failing to save the cache only costs us the shortcut at next boot
+   //
+
+   status = IoOpenDeviceRegistryKey(PFdoData->UnderlyingPDO,
+                                    PLUGPLAY_REGKEY_DEVICE, KEY_WRITE,
+                                    &keyHandle);
+
+   if (!NT_SUCCESS(status)) {
+      Serenum_KdPrint(PFdoData, SER_DBG_SS_ERROR,
+                      ("Failed to open the device key %x\n", status));
+      return;
+   }
+
+   RtlInitUnicodeString(&valueName, SERENUM_IDCACHE_VALUE);
+
+   status = ZwSetValueKey(keyHandle, &valueName, 0, REG_BINARY, pCache,
+                          sizeof(*pCache));
+
+   if (!NT_SUCCESS(status)) {
+      Serenum_KdPrint(PFdoData, SER_DBG_SS_ERROR,
+                      ("Failed to save the ID cache %x\n", status));
+   }
+
+   ZwClose(keyHandle);
+}
+
 NTSTATUS
 Serenum_ReenumerateDevices(IN PIRP Irp, IN PFDO_DEVICE_DATA PFdoData,
                            PBOOLEAN PSameDevice)
@@ -754,6 +929,8 @@ Return value:
    SERIAL_TIMEOUTS timeouts, newTimeouts;
 
    ULONG curTry = 0;
+   ULONG firstPass;
+   ULONG idPass = 0;
    BOOLEAN sameDevice = FALSE;
 
    PAGED_CODE();
@@ -862,19 +1039,49 @@ Return value:
 
 
    //
-   // Run the serial PnP device detection protocol; give it up to 3 tries
+   // Run the serial PnP device detection protocol; give it up to 3 tries.
+   // If the ID cache says which pass the device answered on last time,
+   // start with that pass.
    //
 
+   firstPass = (PFdoData->IdCache.State == SERENUM_IDCACHE_DEVICE)
+      ? PFdoData->IdCache.Pass : 0;
+
    while (curTry <= 2) {
       if (pReadBuf) {
          ExFreePoolWithTag(pReadBuf,SERENUM_POOL_TAG);
          pReadBuf = NULL;
       }
 
-      status = SerenumDoEnumProtocol(PFdoData, (PUCHAR*)&pReadBuf, &nActual,
-                                     &DSRMissing);
+      status = SerenumDoEnumProtocol(PFdoData, firstPass, (PUCHAR*)&pReadBuf,
+                                     &nActual, &DSRMissing, &idPass);
 
       if (status == STATUS_SUCCESS) {
+         if (firstPass == 0
+             || SerenumIdMatchesCache(PFdoData, (PUCHAR)pReadBuf, nActual,
+                                      DSRMissing)) {
+            break;
+         }
+
+         //
+         // Going out of order only pays off for the device we saw last
+         // time.  Something else answered, so run the protocol as it is
+         // written.
+         //
+
+         LOGENTRY(LOG_ENUM, 'SRRM', PFdoData, nActual, idPass);
+         firstPass = 0;
+         continue;
+      }
+
+      //
+      // Nothing answered.  If nothing answered the last time either, the
+      // port is still empty and trying again would only slow us down.
+      //
+
+      if (status == STATUS_TIMEOUT && nActual == 0
+          && PFdoData->IdCache.State == SERENUM_IDCACHE_EMPTY) {
+         LOGENTRY(LOG_ENUM, 'SRRE', PFdoData, 0, 0);
          break;
       }
 
@@ -959,6 +1166,8 @@ Return value:
          pReadBuf = NULL;
       }
 
+      SerenumUpdateIdCache(PFdoData, SERENUM_IDCACHE_EMPTY, 0, NULL, 0, FALSE);
+
       if (pdo != NULL) {
          //
          // Something was there.  The device must have been unplugged.
@@ -975,6 +1184,20 @@ Return value:
    Serenum_KdPrint(PFdoData, SER_DBG_SS_TRACE,
                    ("Something was read from the serial port...\n"));
 
+   //
+   // If the port sent exactly what it sent the last time, the device we
+   // have a pdo for is still there and there is nothing to parse.
+   //
+
+   if (pdo != NULL
+       && SerenumIdMatchesCache(PFdoData, (PUCHAR)pReadBuf, nActual,
+                                DSRMissing)) {
+      Serenum_KdPrint(PFdoData, SER_DBG_SS_TRACE,
+                      ("Cached device. Keeping current Pdo %p\n", pdo));
+      ExFreePoolWithTag(pReadBuf,SERENUM_POOL_TAG);
+      sameDevice = TRUE;
+      goto ExitReenumerate;
+   }
 
 
 #if 0
@@ -1055,6 +1278,9 @@ Return value:
             pdo = NULL;
          }
 
+         SerenumUpdateIdCache(PFdoData, SERENUM_IDCACHE_NONE, 0, NULL, 0,
+                              FALSE);
+
          SerenumFreeUnicodeString(&hardwareIDs);
          SerenumFreeUnicodeString(&compIDs);
          SerenumFreeUnicodeString(&deviceIDs);
@@ -1071,10 +1297,13 @@ Return value:
    }
 
    //
-   // We're now finally able to free this read buffer.
+   // Remember what the device sent; we're then finally able to free this
+   // read buffer.
    //
 
    if (pReadBuf != NULL) {
+      SerenumUpdateIdCache(PFdoData, SERENUM_IDCACHE_DEVICE, idPass,
+                           (PUCHAR)pReadBuf, nActual, DSRMissing);
       ExFreePoolWithTag(pReadBuf,SERENUM_POOL_TAG);
    }
 
@@ -1096,6 +1325,8 @@ Return value:
          pdo = NULL;
       }
 
+      SerenumUpdateIdCache(PFdoData, SERENUM_IDCACHE_NONE, 0, NULL, 0, FALSE);
+
       SerenumFreeUnicodeString(&hardwareIDs);
       SerenumFreeUnicodeString(&compIDs);
       SerenumFreeUnicodeString(&deviceIDs);
@@ -1491,12 +1722,18 @@ Serenum_ReadSerialPort(
 
     *nActual = 0;
 
+    //
+    // With these timeouts a read returns as soon as anything has arrived, so
+    // ask for the rest of the buffer each time rather than a byte at a time.
+    //
+
     while (*nActual < Buflen) {
         KeClearEvent(&event);
 
         pIrp = IoBuildSynchronousFsdRequest(IRP_MJ_READ, FdoData->TopOfStack,
-                                            PReadBuffer, 1, &startingOffset,
-                                            &event, PIoStatusBlock);
+                                            PReadBuffer, Buflen - *nActual,
+                                            &startingOffset, &event,
+                                            PIoStatusBlock);
 
         if (pIrp == NULL) {
             Serenum_KdPrint(FdoData, SER_DBG_SS_ERROR, ("Failed to allocate IRP"
@@ -243,6 +243,27 @@ Arguments:
 
          }
 
+         //
+         // Pick up what the last enumeration of this port found.  Anything
+         // we don't recognize is ignored and the port gets the full protocol.
+         //
+
+         status
+            = Serenum_GetRegistryKeyValue(keyHandle, SERENUM_IDCACHE_VALUE,
+                                          sizeof(SERENUM_IDCACHE_VALUE),
+                                          &pDeviceData->IdCache,
+                                          sizeof(pDeviceData->IdCache),
+                                          &actualLength);
+
+         if ((status != STATUS_SUCCESS)
+             || (actualLength != sizeof(pDeviceData->IdCache))
+             || (pDeviceData->IdCache.State > SERENUM_IDCACHE_DEVICE)
+             || (pDeviceData->IdCache.Pass > 1)
+             || (pDeviceData->IdCache.Length > MAX_DEVNODE_NAME)) {
+            RtlZeroMemory(&pDeviceData->IdCache, sizeof(pDeviceData->IdCache));
+            status = STATUS_SUCCESS;
+         }
+
          ZwClose(keyHandle);
       }
    }
@@ -54,6 +54,20 @@ Revision History:
 
 #define SERENUM_SERIAL_READ_TIME   240
 
+//
+// Registry value, in the port's device key, that holds the ID cache
+//
+
+#define SERENUM_IDCACHE_VALUE   L"LastEnumeratedId"
+
+//
+// What the last enumeration found on the port
+//
+
+#define SERENUM_IDCACHE_NONE    0
+#define SERENUM_IDCACHE_EMPTY   1
+#define SERENUM_IDCACHE_DEVICE  2
+
 //#define SERENUM_INSTANCE_ID_BASE L"Serenum\\Inst_000"
 //#define SERENUM_INSTANCE_ID_BASE_LENGTH 12
 //#define SERENUM_INSTANCE_ID_BASE_PORT_INDEX 10
@@ -219,6 +233,21 @@ typedef struct _PDO_DEVICE_DATA
     //
 } PDO_DEVICE_DATA, *PPDO_DEVICE_DATA;
 
+//
+// The bytes a port returned to the enumeration protocol the last time it was
+// enumerated.  The cache is kept in the port's device key, so an unchanged
+// port is revalidated with a single pass of the protocol even on the first
+// enumeration after boot.
+//
+
+typedef struct _SERENUM_ID_CACHE {
+    ULONG State;        // SERENUM_IDCACHE_XXX
+    ULONG Pass;         // protocol pass the device answered on (0 = modem)
+    ULONG DSRMissing;
+    ULONG Length;
+    UCHAR Id[MAX_DEVNODE_NAME];
+} SERENUM_ID_CACHE, *PSERENUM_ID_CACHE;
+
 
 //
 // The device extension of the bus itself.  From whence the PDO's are born.
@@ -325,6 +354,12 @@ typedef struct _FDO_DEVICE_DATA
 
     LONG ProtocolThreadCount;
 
+    //
+    // What the last enumeration read from the port
+    //
+
+    SERENUM_ID_CACHE IdCache;
+
 } FDO_DEVICE_DATA, *PFDO_DEVICE_DATA;
 
 typedef struct _SERENUM_RELEASE_CONTEXT {
@@ -596,9 +631,24 @@ SerenumSyncCompletion;
 NTSTATUS
 SerenumDoEnumProtocol(
                                   PFDO_DEVICE_DATA PFdoData, 
+                                  ULONG FirstPass,
     _Outptr_result_buffer_(*PNBytes)  PUCHAR *PpBuf, 
                                   PUSHORT PNBytes,
-                                  PBOOLEAN PDSRMissing);
+                                  PBOOLEAN PDSRMissing,
+                                  PULONG PPass);
+
+BOOLEAN
+SerenumIdMatchesCache(IN PFDO_DEVICE_DATA PFdoData,
+     _In_reads_(NBytes) IN PUCHAR PBuf,
+                        IN USHORT NBytes,
+                        IN BOOLEAN DSRMissing);
+
+VOID
+SerenumUpdateIdCache(IN PFDO_DEVICE_DATA PFdoData, IN ULONG State,
+                     IN ULONG Pass,
+  _In_reads_opt_(NBytes) IN PUCHAR PBuf,
+                     IN USHORT NBytes,
+                     IN BOOLEAN DSRMissing);
 
 BOOLEAN
 SerenumValidateID(IN PUNICODE_STRING PId);
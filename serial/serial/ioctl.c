@@ -156,6 +156,10 @@ Return Value:
     RtlZeroMemory(&((PSERIAL_DEVICE_EXTENSION)Context)->WmiPerfData,
                  sizeof(SERIAL_WMI_PERF_DATA));
 
+    ((PSERIAL_DEVICE_EXTENSION)Context)->RxInterruptCount = 0;
+    ((PSERIAL_DEVICE_EXTENSION)Context)->RxInterruptChars = 0;
+    ((PSERIAL_DEVICE_EXTENSION)Context)->RxInterruptMaxChars = 0;
+
     return FALSE;
 }
 
@@ -278,11 +278,13 @@ Return Value:
                     // It may also reveal a new interrupt cause.
                     //
                     UCHAR ReceivedChar;
+                    ULONG CharsRead = 0;
 
                     do {
 
                         ReceivedChar =
                             READ_RECEIVE_BUFFER(Extension, Extension->Controller);
+                        CharsRead++;
                         Extension->PerfStats.ReceivedCount++;
                         Extension->WmiPerfData.ReceivedCount++;
 
@@ -437,6 +439,14 @@ ReceiveDoLineStatus:    ;
 
                            DetectRemoval = READ_INTERRUPT_ID_REG(Extension, Extension->Controller);
 
+                           //
+                           // A 16750 with its 64 byte fifos on sets one of
+                           // the bits that are otherwise zero.
+                           //
+                           if (Extension->FifoDepth == SERIAL_FIFO_DEPTH_16750) {
+                               DetectRemoval &= ~SERIAL_IIR_64BYTE_FIFO;
+                           }
+
                            if(DetectRemoval & SERIAL_IIR_MUST_BE_ZERO)
                            {
                                // break out of this loop and stop processing interrupts
@@ -470,6 +480,8 @@ ReceiveDoLineStatus:    ;
 
                     } WHILE (TRUE);
 
+                    SerialUpdateRxStats(Extension, CharsRead);
+
                     break;
 
                 }
@@ -854,6 +866,60 @@ doTrasmitStuff:;
 
 }
 
+VOID
+SerialUpdateRxStats(
+    IN PSERIAL_DEVICE_EXTENSION Extension,
+    IN ULONG CharsRead
+    )
+
+/*++
+
+Routine Description:
+
+    This routine, which only runs at device level, counts a receive
+    interrupt and the characters it read out of the fifo.  Every
+    SERIAL_RX_STATS_INTERVAL receive interrupts it traces how well the
+    rx trigger is coalescing characters, and the overruns so far.
+
+Arguments:
+
+    Extension - The serial device extension.
+
+    CharsRead - The characters read during this interrupt.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    Extension->RxInterruptCount++;
+    Extension->RxInterruptChars += CharsRead;
+
+    if (CharsRead > Extension->RxInterruptMaxChars) {
+
+        Extension->RxInterruptMaxChars = CharsRead;
+
+    }
+
+    if ((Extension->RxInterruptCount != 0) &&
+        ((Extension->RxInterruptCount % SERIAL_RX_STATS_INTERVAL) == 0)) {
+
+        SerialDbgPrintEx(TRACE_LEVEL_INFORMATION, DBG_INTERRUPT,
+                         "Port %p: %lu rx interrupts, %I64u chars per "
+                         "interrupt, at most %lu, %lu fifo overruns, %lu "
+                         "buffer overruns\n",
+                         Extension->Controller,
+                         Extension->RxInterruptCount,
+                         Extension->RxInterruptChars / Extension->RxInterruptCount,
+                         Extension->RxInterruptMaxChars,
+                         Extension->PerfStats.SerialOverrunErrorCount,
+                         Extension->PerfStats.BufferOverrunErrorCount);
+
+    }
+}
+
 VOID
 SerialPutChar(
     IN PSERIAL_DEVICE_EXTENSION Extension,
@@ -427,7 +427,8 @@ SerialFileCloseWorker(
         // have been emptied out of the hardware.
         //
 
-        for (flushCount = (20 * 16); flushCount != 0; flushCount--) {
+        for (flushCount = (20 * max(extension->FifoDepth, SERIAL_FIFO_DEPTH_16550));
+             flushCount != 0; flushCount--) {
            if ((READ_LINE_STATUS(extension, extension->Controller) &
                 (SERIAL_LSR_THRE | SERIAL_LSR_TEMT)) !=
                (SERIAL_LSR_THRE | SERIAL_LSR_TEMT)) {
@@ -817,6 +817,12 @@ Return Value:
         pConfig->TL16C550CAFC = 0;
     }
 
+    if(!SerialGetRegistryKeyValue(Device,
+                                 L"FifoDepth",
+                                 &pConfig->FifoDepth)){
+        pConfig->FifoDepth = SERIAL_FIFO_DEPTH_DEFAULT;
+    }
+
     status = SerialInitController(pDevExt, pConfig);
 
     if (NT_SUCCESS(status)) {
@@ -1237,41 +1243,30 @@ Return Value:
 
     //
     // Before we test whether the port exists (which will enable the FIFO)
-    // convert the rx trigger value to what should be used in the register.
-    //
-    // If a bogus value was given - crank them down to 1.
-    //
-    // If this is a "souped up" UART with like a 64 byte FIFO, they
-    // should use the appropriate "spoofing" value to get the desired
-    // results.  I.e., if on their chip 0xC0 in the FCR is for 64 bytes,
-    // they should specify 14 in the registry.
+    // Save the rx trigger value.  It is converted to what should be used
+    // in the register by SerialDoesPortExist, once it knows how deep the
+    // fifos are.
     //
 
-    switch (PConfigData->RxFIFO) {
+    pDevExt->RxFifoLevel = PConfigData->RxFIFO;
 
-    case 1:
-
-      pDevExt->RxFifoTrigger = SERIAL_1_BYTE_HIGH_WATER;
-      break;
-
-    case 4:
-
-      pDevExt->RxFifoTrigger = SERIAL_4_BYTE_HIGH_WATER;
-      break;
+    //
+    // Save the fifo depth the registry asks for.  Anything but a depth we
+    // know of is taken as a request to detect it.
+    //
 
-    case 8:
+    switch (PConfigData->FifoDepth) {
 
-      pDevExt->RxFifoTrigger = SERIAL_8_BYTE_HIGH_WATER;
-      break;
+    case SERIAL_FIFO_DEPTH_16550:
+    case SERIAL_FIFO_DEPTH_16750:
+    case SERIAL_FIFO_DEPTH_16950:
 
-    case 14:
-
-      pDevExt->RxFifoTrigger = SERIAL_14_BYTE_HIGH_WATER;
+      pDevExt->FifoDepth = PConfigData->FifoDepth;
       break;
 
     default:
 
-      pDevExt->RxFifoTrigger = SERIAL_1_BYTE_HIGH_WATER;
+      pDevExt->FifoDepth = 0;
       break;
 
     }
@@ -1308,6 +1303,16 @@ Return Value:
 
     }
 
+    //
+    // Never put more characters in the transmit fifo than it holds.
+    //
+
+    if (pDevExt->FifoPresent && (pDevExt->TxFifoAmount > pDevExt->FifoDepth)) {
+
+      pDevExt->TxFifoAmount = pDevExt->FifoDepth;
+
+    }
+
 
     //
     // If the user requested that we disable the port, then
@@ -2344,31 +2349,49 @@ Return Value:
          Extension->FifoPresent = TRUE;
 
          //
-         // There is a fine new "super" IO chip out there that
-         // will get stuck with a line status interrupt if you
-         // attempt to clear the fifo and enable it at the same
-         // time if data is present.  The best workaround seems
-         // to be that you should turn off the fifo read a single
-         // byte, and then re-enable the fifo.
+         // Unless the registry says how deep the fifos are, see if
+         // this is a 16750 by asking for its 64 byte fifos.  A 16950
+         // can't be told from a 16550 without registers that are
+         // specific to it, so it must be named in the registry.
          //
 
-         WRITE_FIFO_CONTROL(Extension,
-                           Extension->Controller,
-                           (UCHAR)0
-                           );
+         if (Extension->FifoDepth == 0) {
+
+            UCHAR oldLineControl = READ_LINE_CONTROL(Extension, Extension->Controller);
+
+            WRITE_LINE_CONTROL(Extension, Extension->Controller, SERIAL_LCR_DLAB);
+            WRITE_FIFO_CONTROL(Extension,
+                              Extension->Controller,
+                              (UCHAR)(SERIAL_FCR_ENABLE | SERIAL_FCR_64BYTE_FIFO)
+                              );
+            WRITE_LINE_CONTROL(Extension, Extension->Controller, oldLineControl);
+
+            regContents = READ_INTERRUPT_ID_REG(Extension, Extension->Controller);
+
+            if (regContents & SERIAL_IIR_64BYTE_FIFO) {
 
-         READ_RECEIVE_BUFFER(Extension, Extension->Controller);
+               Extension->FifoDepth = SERIAL_FIFO_DEPTH_16750;
+
+            } else {
+
+               Extension->FifoDepth = SERIAL_FIFO_DEPTH_16550;
+
+            }
+
+         }
 
          //
          // There are fifos on this card.  Set the value of the
-         // receive fifo to interrupt when 4 characters are present.
+         // receive fifo to interrupt at the level nearest to what
+         // the registry asks for.
          //
 
-         WRITE_FIFO_CONTROL(Extension, Extension->Controller,
-                            (UCHAR)(SERIAL_FCR_ENABLE
-                                    | Extension->RxFifoTrigger
-                                    | SERIAL_FCR_RCVR_RESET
-                                    | SERIAL_FCR_TXMT_RESET));
+         Extension->RxFifoTrigger = SerialGetRxFifoTrigger(
+                                       Extension->FifoDepth,
+                                       Extension->RxFifoLevel
+                                       );
+
+         SerialEnableFifo(Extension);
 
       }
 
@@ -2381,6 +2404,7 @@ Return Value:
       if (!ForceFifo || !Extension->FifoPresent) {
 
          Extension->FifoPresent = FALSE;
+         Extension->FifoDepth = 0;
          WRITE_FIFO_CONTROL(Extension,
                            Extension->Controller,
                            (UCHAR)0
@@ -2412,8 +2436,11 @@ Return Value:
          }
 
          SerialDbgPrintEx(TRACE_LEVEL_INFORMATION, DBG_PNP,
-                          "Fifo's detected at port address: %p\n",
-                          Extension->Controller);
+                          "Fifo's detected at port address: %p, depth %lu,"
+                          " rx trigger 0x%x\n",
+                          Extension->Controller,
+                          Extension->FifoDepth,
+                          Extension->RxFifoTrigger);
       }
    }
 
@@ -2422,6 +2449,195 @@ Return Value:
 
 
 
+UCHAR
+SerialGetRxFifoTrigger(
+    IN ULONG FifoDepth,
+    IN ULONG RxFifo
+    )
+
+/*++
+
+Routine Description:
+
+    This routine converts the RxFIFO registry value to the rx trigger
+    value that should be used in the fifo control register.
+
+    The values a 16550 supports, 1, 4, 8 and 14, keep selecting the same
+    register value on every chip, so a registry that "spoofs" a deeper
+    fifo, specifying 14 to get what 0xC0 means on that chip, still gets
+    it.  Any other value is a character count, and selects the highest
+    level of this chip that doesn't exceed it, or the lowest level.
+
+Arguments:
+
+    FifoDepth - One of the SERIAL_FIFO_DEPTH_ values.
+
+    RxFifo - The RxFIFO registry value.
+
+Return Value:
+
+    The encoded rx trigger.
+
+--*/
+
+{
+   static const UCHAR triggers[] = {
+      SERIAL_1_BYTE_HIGH_WATER,
+      SERIAL_4_BYTE_HIGH_WATER,
+      SERIAL_8_BYTE_HIGH_WATER,
+      SERIAL_14_BYTE_HIGH_WATER
+   };
+   static const ULONG levels16550[] = {1, 4, 8, 14};
+   static const ULONG levels16750[] = {1, 16, 32, 56};
+   static const ULONG levels16950[] = {16, 32, 112, 120};
+   const ULONG *levels;
+   ULONG i;
+
+   switch (RxFifo) {
+
+   case 1:
+
+      return SERIAL_1_BYTE_HIGH_WATER;
+
+   case 4:
+
+      return SERIAL_4_BYTE_HIGH_WATER;
+
+   case 8:
+
+      return SERIAL_8_BYTE_HIGH_WATER;
+
+   case 14:
+
+      return SERIAL_14_BYTE_HIGH_WATER;
+
+   }
+
+   switch (FifoDepth) {
+
+   case SERIAL_FIFO_DEPTH_16750:
+
+      levels = levels16750;
+      break;
+
+   case SERIAL_FIFO_DEPTH_16950:
+
+      levels = levels16950;
+      break;
+
+   default:
+
+      levels = levels16550;
+      break;
+
+   }
+
+   for (i = RTL_NUMBER_OF(triggers) - 1; i > 0; i--) {
+
+      if (levels[i] <= RxFifo) {
+
+         break;
+
+      }
+
+   }
+
+   return triggers[i];
+}
+
+
+
+VOID
+SerialEnableFifo(
+    IN PSERIAL_DEVICE_EXTENSION Extension
+    )
+
+/*++
+
+Routine Description:
+
+    This routine resets and enables the fifos, at the depth found by
+    SerialDoesPortExist and with the current rx trigger.
+
+    NOTE: This assumes that it is called at interrupt level, or
+          before interrupts are connected.
+
+Arguments:
+
+    Extension - The serial device extension.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+   UCHAR oldLineControl;
+   UCHAR fifoControl = (UCHAR)(SERIAL_FCR_ENABLE | Extension->RxFifoTrigger |
+                               SERIAL_FCR_RCVR_RESET | SERIAL_FCR_TXMT_RESET);
+
+   //
+   // There is a fine new "super" IO chip out there that
+   // will get stuck with a line status interrupt if you
+   // attempt to clear the fifo and enable it at the same
+   // time if data is present.  The best workaround seems
+   // to be that you should turn off the fifo read a single
+   // byte, and then re-enable the fifo.
+   //
+
+   WRITE_FIFO_CONTROL(Extension,
+                     Extension->Controller,
+                     (UCHAR)0
+                     );
+
+   READ_RECEIVE_BUFFER(Extension, Extension->Controller);
+
+   oldLineControl = READ_LINE_CONTROL(Extension, Extension->Controller);
+
+   switch (Extension->FifoDepth) {
+
+   case SERIAL_FIFO_DEPTH_16750:
+
+      //
+      // The 64 byte fifo bit can only be written with the divisor
+      // latch selected.
+      //
+
+      WRITE_LINE_CONTROL(Extension, Extension->Controller, SERIAL_LCR_DLAB);
+      WRITE_FIFO_CONTROL(Extension,
+                        Extension->Controller,
+                        (UCHAR)(fifoControl | SERIAL_FCR_64BYTE_FIFO)
+                        );
+      WRITE_LINE_CONTROL(Extension, Extension->Controller, oldLineControl);
+      break;
+
+   case SERIAL_FIFO_DEPTH_16950:
+
+      //
+      // Enhanced mode gives the 128 byte fifos.
+      //
+
+      WRITE_LINE_CONTROL(Extension, Extension->Controller, SERIAL_LCR_EFR_ACCESS);
+      WRITE_ENHANCED_FEATURES(Extension,
+                             Extension->Controller,
+                             (UCHAR)(READ_ENHANCED_FEATURES(Extension, Extension->Controller)
+                                     | SERIAL_EFR_ENHANCED)
+                             );
+      WRITE_LINE_CONTROL(Extension, Extension->Controller, oldLineControl);
+      WRITE_FIFO_CONTROL(Extension, Extension->Controller, fifoControl);
+      break;
+
+   default:
+
+      WRITE_FIFO_CONTROL(Extension, Extension->Controller, fifoControl);
+      break;
+
+   }
+}
+
+
+
 BOOLEAN
 SerialReset(
     IN WDFINTERRUPT  Interrupt,
@@ -2473,27 +2689,7 @@ Return Value:
 
    if (extension->FifoPresent) {
 
-      //
-      // There is a fine new "super" IO chip out there that
-      // will get stuck with a line status interrupt if you
-      // attempt to clear the fifo and enable it at the same
-      // time if data is present.  The best workaround seems
-      // to be that you should turn off the fifo read a single
-      // byte, and then re-enable the fifo.
-      //
-
-      WRITE_FIFO_CONTROL(extension,
-                        extension->Controller,
-                        (UCHAR)0
-                        );
-
-      READ_RECEIVE_BUFFER(extension, extension->Controller);
-
-      WRITE_FIFO_CONTROL(extension,
-                        extension->Controller,
-                        (UCHAR)(SERIAL_FCR_ENABLE | extension->RxFifoTrigger |
-                                SERIAL_FCR_RCVR_RESET | SERIAL_FCR_TXMT_RESET)
-                        );
+      SerialEnableFifo(extension);
 
    }
 
@@ -146,12 +146,7 @@ Return Value:
     //
 
     if (deviceExtension->FifoPresent) {
-       WRITE_FIFO_CONTROL(deviceExtension, deviceExtension->Controller, (UCHAR)0);
-       READ_RECEIVE_BUFFER(deviceExtension, deviceExtension->Controller);
-       WRITE_FIFO_CONTROL(deviceExtension, deviceExtension->Controller,
-                          (UCHAR)(SERIAL_FCR_ENABLE | deviceExtension->RxFifoTrigger
-                                  | SERIAL_FCR_RCVR_RESET
-                                  | SERIAL_FCR_TXMT_RESET));
+       SerialEnableFifo(deviceExtension);
     } else {
        WRITE_FIFO_CONTROL(deviceExtension, deviceExtension->Controller, (UCHAR)0);
     }
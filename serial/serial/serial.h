@@ -25,6 +25,13 @@ Abstract:
 #define SERIAL_TX_FIFO_DEFAULT          14
 #define SERIAL_PERMIT_SHARE_DEFAULT     0
 #define SERIAL_LOG_FIFO_DEFAULT         0
+#define SERIAL_FIFO_DEPTH_DEFAULT       0
+
+//
+// Every this many receive interrupts, the characters per interrupt and
+// the overruns are traced.
+//
+#define SERIAL_RX_STATS_INTERVAL        4096
 
 
 //
@@ -90,6 +97,7 @@ Abstract:
 #define MODEM_STATUS_REGISTER      ((ULONG)((0x06)*SERIAL_REGISTER_STRIDE))
 #define DIVISOR_LATCH_LSB          ((ULONG)((0x00)*SERIAL_REGISTER_STRIDE))
 #define DIVISOR_LATCH_MSB          ((ULONG)((0x01)*SERIAL_REGISTER_STRIDE))
+#define ENHANCED_FEATURE_REGISTER  ((ULONG)((0x02)*SERIAL_REGISTER_STRIDE))
 #define SERIAL_REGISTER_SPAN       ((ULONG)(7*SERIAL_REGISTER_STRIDE))
 
 //
@@ -164,6 +172,12 @@ Abstract:
 //
 #define SERIAL_IIR_FIFOS_ENABLED 0xc0
 
+//
+// On a 16750 this bit of the interrupt id register is set when the
+// 64 byte fifos are enabled.
+//
+#define SERIAL_IIR_64BYTE_FIFO   0x20
+
 //
 // If the low bit is logic one in the interrupt identification register
 // this implies that *NO* interrupts are pending on the device.
@@ -203,6 +217,31 @@ Abstract:
 #define SERIAL_8_BYTE_HIGH_WATER   ((UCHAR)0x80)
 #define SERIAL_14_BYTE_HIGH_WATER  ((UCHAR)0xc0)
 
+//
+// Setting this bit in the fifo control register of a 16750 while the
+// divisor latch is selected turns on its 64 byte fifos.  The high water
+// marks above then trip at 1, 16, 32 and 56 characters.
+//
+#define SERIAL_FCR_64BYTE_FIFO     ((UCHAR)0x20)
+
+//
+// The fifo depths the driver knows of.  A 16950 gets its 128 byte fifos
+// in enhanced (650 compatible) mode, where the high water marks trip at
+// 16, 32, 112 and 120 characters.
+//
+#define SERIAL_FIFO_DEPTH_16550    16
+#define SERIAL_FIFO_DEPTH_16750    64
+#define SERIAL_FIFO_DEPTH_16950    128
+
+//
+// Writing this value to the line control register of a 16650 class chip,
+// which includes the 16950, maps the enhanced feature register where the
+// fifo control register is.  Setting SERIAL_EFR_ENHANCED in it enables the
+// enhanced mode.
+//
+#define SERIAL_LCR_EFR_ACCESS      ((UCHAR)0xbf)
+#define SERIAL_EFR_ENHANCED        ((UCHAR)0x10)
+
 //
 // These masks define access to the line control register.
 //
@@ -453,6 +492,7 @@ typedef struct _CONFIG_DATA {
     ULONG               TrIrql;
     KAFFINITY           Affinity;
     ULONG               TL16C550CAFC;
+    ULONG               FifoDepth;
     } CONFIG_DATA,*PCONFIG_DATA;
 
 
@@ -1078,6 +1118,15 @@ typedef struct _SERIAL_DEVICE_EXTENSION {
     //
     SERIALPERF_STATS PerfStats;
 
+    //
+    // Receive interrupts, the characters they read out of the fifo, and
+    // the most any one of them read.  Reset with the perf stats.  Only set
+    // at device level.
+    //
+    ULONG RxInterruptCount;
+    ULONGLONG RxInterruptChars;
+    ULONG RxInterruptMaxChars;
+
     //
     // This holds what we beleive to be the current value of
     // the line control register.
@@ -1174,6 +1223,19 @@ typedef struct _SERIAL_DEVICE_EXTENSION {
     //
     UCHAR RxFifoTrigger;
 
+    //
+    // The RxFIFO value from the registry, which RxFifoTrigger is derived
+    // from once the depth of the fifo is known.
+    //
+    ULONG RxFifoLevel;
+
+    //
+    // The depth of the fifos, one of the SERIAL_FIFO_DEPTH_ values, or 0
+    // if there are none.  Before the port is examined this is the
+    // FifoDepth value from the registry, where 0 means detect it.
+    //
+    ULONG FifoDepth;
+
     //
     // This points to a DPC used to complete write requests.
     //
@@ -1681,6 +1743,30 @@ do                                                             \
         (ControlValue)                                         \
         );                                                     \
 } WHILE (0)
+
+//
+// These macros read and write the enhanced feature register of a 16650
+// class chip.  The line control register must hold SERIAL_LCR_EFR_ACCESS.
+//
+// Arguments:
+//
+// BaseAddress - A pointer to the address from which the hardware
+//               device registers are located.
+//
+// Features - The value to set the enhanced feature register to.
+//
+//
+#define READ_ENHANCED_FEATURES(Extension, BaseAddress)                    \
+    (Extension->SerialReadUChar((BaseAddress)+ENHANCED_FEATURE_REGISTER))
+
+#define WRITE_ENHANCED_FEATURES(Extension, BaseAddress,Features)          \
+do                                                             \
+{                                                              \
+    Extension->SerialWriteUChar(                                          \
+        (BaseAddress)+ENHANCED_FEATURE_REGISTER,               \
+        (Features)                                             \
+        );                                                     \
+} WHILE (0)
 
 //
 // This macro writes to the modem control register
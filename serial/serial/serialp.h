@@ -263,6 +263,12 @@ SerialPutChar(
     IN UCHAR CharToPut
     );
 
+VOID
+SerialUpdateRxStats(
+    IN PSERIAL_DEVICE_EXTENSION Extension,
+    IN ULONG CharsRead
+    );
+
 NTSTATUS
 SerialGetConfigDefaults(
     IN PSERIAL_FIRMWARE_DATA DriverDefaultsPtr,
@@ -354,6 +360,17 @@ SerialDoesPortExist(
     IN ULONG LogFifo
     );
 
+UCHAR
+SerialGetRxFifoTrigger(
+    IN ULONG FifoDepth,
+    IN ULONG RxFifo
+    );
+
+VOID
+SerialEnableFifo(
+    IN PSERIAL_DEVICE_EXTENSION Extension
+    );
+
 SERIAL_MEM_COMPARES
 SerialMemCompare(
     IN PHYSICAL_ADDRESS A,
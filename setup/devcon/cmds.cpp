@@ -33,6 +33,8 @@ struct GenericContext {
 #define FIND_CLASS          0x00000040 // display device's setup class
 #define FIND_STACK          0x00000080 // display device's driver-stack
 
+#define EXPORT_STDOUT_BUFFER 0x10000    // stdout buffer size while exporting
+
 struct SetHwidContext {
     int argc_right;
     LPTSTR * argv_right;
@@ -41,6 +43,52 @@ struct SetHwidContext {
     int modified;
 };
 
+#define CONTROL_FAILED      0 // DIF_PROPERTYCHANGE failed
+#define CONTROL_DONE        1 // state changed
+#define CONTROL_REBOOT      2 // state changed, reboot required
+
+#define BATCH_MAX_LINE        4096 // longest line in a batch file
+#define BATCH_MAX_ARGS        64   // most tokens on a line of a batch file
+#define BATCH_MAX_WORKERS     MAXIMUM_WAIT_OBJECTS
+#define BATCH_DEFAULT_WORKERS 4
+#define BATCH_OPS             3    // entries in BatchOps
+
+struct BatchOp {
+    int       op;       // index into BatchOps
+    BatchOp * next;     // next operation on the same device, in file order
+};
+
+struct BatchDevice {
+    TCHAR     instanceId[MAX_DEVICE_ID_LEN];
+    BatchOp * first;
+    BatchOp * last;
+};
+
+struct BatchContext {
+    BatchDevice *  devices;         // indexed by position in the shared device info list
+    DWORD          numDevices;
+    DWORD          maxDevices;
+    int            op;              // operation of the line being read
+    DWORD          matched;         // devices matched by the line being read
+    LONG volatile  nextDevice;      // next device for a worker to take
+    GenericContext results[BATCH_OPS];
+    TCHAR          strings[BATCH_OPS][3][80];
+};
+
+static const struct {
+    LPCTSTR cmd;
+    DWORD   control;
+    UINT    idsSuccess;
+    UINT    idsReboot;
+    UINT    idsFail;
+    DWORD   msgTail;
+    DWORD   msgTailReboot;
+} BatchOps[BATCH_OPS] = {
+    { TEXT("enable"),  DICS_ENABLE,     IDS_ENABLED,   IDS_ENABLED_REBOOT,  IDS_ENABLE_FAILED,  MSG_ENABLE_TAIL,  MSG_ENABLE_TAIL_REBOOT },
+    { TEXT("disable"), DICS_DISABLE,    IDS_DISABLED,  IDS_DISABLED_REBOOT, IDS_DISABLE_FAILED, MSG_DISABLE_TAIL, MSG_DISABLE_TAIL_REBOOT },
+    { TEXT("restart"), DICS_PROPCHANGE, IDS_RESTARTED, IDS_REQUIRES_REBOOT, IDS_RESTART_FAILED, MSG_RESTART_TAIL, MSG_RESTART_TAIL_REBOOT },
+};
+
 int cmdHelp(_In_ LPCTSTR BaseName, _In_opt_ LPCTSTR Machine, _In_ DWORD Flags, _In_ int argc, _In_reads_(argc) PTSTR argv[])
 /*++
 
@@ -467,6 +515,95 @@ Return Value:
     return failcode;
 }
 
+int ExportCallback(_In_ HDEVINFO Devs, _In_ PSP_DEVINFO_DATA DevInfo, _In_ DWORD Index, _In_ LPVOID Context)
+/*++
+
+Routine Description:
+
+    Callback for use by Export
+    writes the device to stdout as soon as it's enumerated
+
+Arguments:
+
+    Devs    )_ uniquely identify the device
+    DevInfo )
+    Index    - index of device
+    Context  - ExportContext
+
+Return Value:
+
+    EXIT_xxxx
+
+--*/
+{
+    UNREFERENCED_PARAMETER(Index);
+
+    return ExportDevice((ExportContext*)Context,Devs,DevInfo) ? EXIT_OK : EXIT_FAIL;
+}
+
+int cmdExport(_In_ LPCTSTR BaseName, _In_opt_ LPCTSTR Machine, _In_ DWORD Flags, _In_ int argc, _In_reads_(argc) PTSTR argv[])
+/*++
+
+Routine Description:
+
+    EXPORT [-json|-csv] <id> ...
+    use EnumerateDevices to do hardwareID matching
+    for each match, write a fixed set of properties to stdout
+    as JSON or CSV, in a single pass over the devices
+
+Arguments:
+
+    BaseName  - name of executable
+    Machine   - must be NULL (CM_Get_DevNode_Property is local only)
+    argc/argv - remaining parameters - passed into EnumerateDevices
+
+Return Value:
+
+    EXIT_xxxx
+
+--*/
+{
+    ExportContext context;
+    int failcode;
+
+    UNREFERENCED_PARAMETER(Flags);
+
+    ZeroMemory(&context,sizeof(context));
+    context.Format = EXPORT_FORMAT_JSON;
+
+    if(Machine) {
+        return EXIT_USAGE;
+    }
+    if(argc && ((argv[0][0]==TEXT('-')) || (argv[0][0]==TEXT('/')))) {
+        if(_tcsicmp(argv[0]+1,TEXT("csv"))==0) {
+            context.Format = EXPORT_FORMAT_CSV;
+        } else if(_tcsicmp(argv[0]+1,TEXT("json"))!=0) {
+            return EXIT_USAGE;
+        }
+        argc--;
+        argv++;
+    }
+    if(!argc) {
+        return EXIT_USAGE;
+    }
+
+    //
+    // records are written with one call each, let the CRT
+    // gather them into large writes
+    //
+    setvbuf(stdout,NULL,_IOFBF,EXPORT_STDOUT_BUFFER);
+
+    if(!ExportHeader(&context)) {
+        ExportFooter(&context);
+        return EXIT_FAIL;
+    }
+    failcode = EnumerateDevices(BaseName,NULL,DIGCF_PRESENT,argc,argv,ExportCallback,&context);
+    if(!ExportFooter(&context) && (failcode == EXIT_OK)) {
+        failcode = EXIT_FAIL;
+    }
+    return failcode;
+}
+
 int cmdStatus(_In_ LPCTSTR BaseName, _In_opt_ LPCTSTR Machine, _In_ DWORD Flags, _In_ int argc, _In_reads_(argc) PTSTR argv[])
 /*++
 
@@ -760,12 +897,11 @@ Return Value:
 
 
 
-int ControlCallback(_In_ HDEVINFO Devs, _In_ PSP_DEVINFO_DATA DevInfo, _In_ DWORD Index, _In_ LPVOID Context)
+int ControlDevice(_In_ HDEVINFO Devs, _In_ PSP_DEVINFO_DATA DevInfo, _In_ DWORD Control)
 /*++
 
 Routine Description:
 
-    Callback for use by Enable/Disable/Restart
     Invokes DIF_PROPERTYCHANGE with correct parameters
     uses SetupDiCallClassInstaller so cannot be done for remote devices
     Don't use CM_xxx API's, they bypass class/co-installers and this is bad.
@@ -776,22 +912,18 @@ Arguments:
 
     Devs    )_ uniquely identify the device
     DevInfo )
-    Index    - index of device
-    Context  - GenericContext
+    Control  - DICS_ENABLE, DICS_DISABLE or DICS_PROPCHANGE
 
 Return Value:
 
-    EXIT_xxxx
+    CONTROL_xxxx
 
 --*/
 {
     SP_PROPCHANGE_PARAMS pcp;
-    GenericContext *pControlContext = (GenericContext*)Context;
     SP_DEVINSTALL_PARAMS devParams;
 
-    UNREFERENCED_PARAMETER(Index);
-
-    switch(pControlContext->control) {
+    switch(Control) {
         case DICS_ENABLE:
             //
             // enable both on global and config-specific profile
@@ -801,7 +933,7 @@ Return Value:
             //
             pcp.ClassInstallHeader.cbSize = sizeof(SP_CLASSINSTALL_HEADER);
             pcp.ClassInstallHeader.InstallFunction = DIF_PROPERTYCHANGE;
-            pcp.StateChange = pControlContext->control;
+            pcp.StateChange = Control;
             pcp.Scope = DICS_FLAG_GLOBAL;
             pcp.HwProfile = 0;
             //
@@ -815,7 +947,7 @@ Return Value:
             //
             pcp.ClassInstallHeader.cbSize = sizeof(SP_CLASSINSTALL_HEADER);
             pcp.ClassInstallHeader.InstallFunction = DIF_PROPERTYCHANGE;
-            pcp.StateChange = pControlContext->control;
+            pcp.StateChange = Control;
             pcp.Scope = DICS_FLAG_CONFIGSPECIFIC;
             pcp.HwProfile = 0;
             break;
@@ -826,7 +958,7 @@ Return Value:
             //
             pcp.ClassInstallHeader.cbSize = sizeof(SP_CLASSINSTALL_HEADER);
             pcp.ClassInstallHeader.InstallFunction = DIF_PROPERTYCHANGE;
-            pcp.StateChange = pControlContext->control;
+            pcp.StateChange = Control;
             pcp.Scope = DICS_FLAG_CONFIGSPECIFIC;
             pcp.HwProfile = 0;
             break;
@@ -838,22 +970,62 @@ Return Value:
         //
         // failed to invoke DIF_PROPERTYCHANGE
         //
-        DumpDeviceWithInfo(Devs,DevInfo,pControlContext->strFail);
-    } else {
-        //
-        // see if device needs reboot
-        //
-        devParams.cbSize = sizeof(devParams);
-        if(SetupDiGetDeviceInstallParams(Devs,DevInfo,&devParams) && (devParams.Flags & (DI_NEEDRESTART|DI_NEEDREBOOT))) {
-                DumpDeviceWithInfo(Devs,DevInfo,pControlContext->strReboot);
-                pControlContext->reboot = TRUE;
-        } else {
-            //
-            // appears to have succeeded
-            //
+        return CONTROL_FAILED;
+    }
+    //
+    // see if device needs reboot
+    //
+    devParams.cbSize = sizeof(devParams);
+    if(SetupDiGetDeviceInstallParams(Devs,DevInfo,&devParams) && (devParams.Flags & (DI_NEEDRESTART|DI_NEEDREBOOT))) {
+        return CONTROL_REBOOT;
+    }
+    //
+    // appears to have succeeded
+    //
+    return CONTROL_DONE;
+}
+
+int ControlCallback(_In_ HDEVINFO Devs, _In_ PSP_DEVINFO_DATA DevInfo, _In_ DWORD Index, _In_ LPVOID Context)
+/*++
+
+Routine Description:
+
+    Callback for use by Enable/Disable/Restart
+    uses ControlDevice to change the state of the device
+    and reports the result
+
+Arguments:
+
+    Devs    )_ uniquely identify the device
+    DevInfo )
+    Index    - index of device
+    Context  - GenericContext
+
+Return Value:
+
+    EXIT_xxxx
+
+--*/
+{
+    GenericContext *pControlContext = (GenericContext*)Context;
+
+    UNREFERENCED_PARAMETER(Index);
+
+    switch(ControlDevice(Devs,DevInfo,pControlContext->control)) {
+        case CONTROL_FAILED:
+            DumpDeviceWithInfo(Devs,DevInfo,pControlContext->strFail);
+            break;
+
+        case CONTROL_REBOOT:
+            DumpDeviceWithInfo(Devs,DevInfo,pControlContext->strReboot);
+            pControlContext->reboot = TRUE;
+            pControlContext->count++;
+            break;
+
+        default:
             DumpDeviceWithInfo(Devs,DevInfo,pControlContext->strSuccess);
-        }
-        pControlContext->count++;
+            pControlContext->count++;
+            break;
     }
     return EXIT_OK;
 }
@@ -1077,6 +1249,365 @@ Return Value:
     return failcode;
 }
 
+int BatchCollectCallback(_In_ HDEVINFO Devs, _In_ PSP_DEVINFO_DATA DevInfo, _In_ DWORD Index, _In_ LPVOID Context)
+/*++
+
+Routine Description:
+
+    Callback for use by Batch while reading the batch file
+    queues the operation of the current line against the device
+    operations on the same device are kept in file order
+
+Arguments:
+
+    Devs    )_ uniquely identify the device
+    DevInfo )
+    Index    - index of device in the shared device info list
+    Context  - BatchContext
+
+Return Value:
+
+    EXIT_xxxx
+
+--*/
+{
+    BatchContext *pBatchContext = (BatchContext*)Context;
+    BatchDevice *device;
+    BatchOp *op;
+
+    if(Index >= pBatchContext->maxDevices) {
+        //
+        // grow the device table, the list may have grown if the line
+        // named non-present devices by instance ID
+        //
+        DWORD maxDevices = pBatchContext->maxDevices ? pBatchContext->maxDevices*2 : 256;
+        BatchDevice *devices;
+
+        if(maxDevices <= Index) {
+            maxDevices = Index+1;
+        }
+        devices = new BatchDevice[maxDevices];
+        if(!devices) {
+            return EXIT_FAIL;
+        }
+        ZeroMemory(devices,sizeof(BatchDevice)*maxDevices);
+        if(pBatchContext->devices) {
+            CopyMemory(devices,pBatchContext->devices,sizeof(BatchDevice)*pBatchContext->maxDevices);
+            delete [] pBatchContext->devices;
+        }
+        pBatchContext->devices = devices;
+        pBatchContext->maxDevices = maxDevices;
+    }
+
+    device = &pBatchContext->devices[Index];
+    if(!device->first) {
+        //
+        // workers re-open the device by instance ID
+        //
+        if(!SetupDiGetDeviceInstanceId(Devs,DevInfo,device->instanceId,ARRAYSIZE(device->instanceId),NULL)) {
+            return EXIT_FAIL;
+        }
+    }
+    op = new BatchOp;
+    if(!op) {
+        return EXIT_FAIL;
+    }
+    op->op = pBatchContext->op;
+    op->next = NULL;
+    if(device->last) {
+        device->last->next = op;
+    } else {
+        device->first = op;
+    }
+    device->last = op;
+
+    if(Index >= pBatchContext->numDevices) {
+        pBatchContext->numDevices = Index+1;
+    }
+    pBatchContext->matched++;
+    return EXIT_OK;
+}
+
+DWORD WINAPI BatchWorker(_In_ LPVOID Context)
+/*++
+
+Routine Description:
+
+    Worker thread for use by Batch
+    repeatedly takes the next device from the table and runs all
+    operations queued against it, in order
+    class installer state is kept in the device info list, so each device
+    is opened into a private list rather than sharing the enumerated one
+
+Arguments:
+
+    Context  - BatchContext
+
+Return Value:
+
+    0
+
+--*/
+{
+    BatchContext *pBatchContext = (BatchContext*)Context;
+    BatchDevice *device;
+    BatchOp *op;
+    GenericContext *result;
+    HDEVINFO devs;
+    SP_DEVINFO_DATA devInfo;
+    BOOL opened;
+    LONG index;
+    int status;
+
+    for(;;) {
+        index = InterlockedIncrement(&pBatchContext->nextDevice)-1;
+        if((DWORD)index >= pBatchContext->numDevices) {
+            break;
+        }
+        device = &pBatchContext->devices[index];
+        if(!device->first) {
+            continue;
+        }
+
+        devInfo.cbSize = sizeof(devInfo);
+        devs = SetupDiCreateDeviceInfoList(NULL,NULL);
+        opened = (devs != INVALID_HANDLE_VALUE) &&
+                 SetupDiOpenDeviceInfo(devs,device->instanceId,NULL,0,&devInfo);
+
+        for(op = device->first;op;op = op->next) {
+            result = &pBatchContext->results[op->op];
+            status = opened ? ControlDevice(devs,&devInfo,result->control) : CONTROL_FAILED;
+            switch(status) {
+                case CONTROL_FAILED:
+                    _tprintf(TEXT("%-60s: %s\n"),device->instanceId,result->strFail);
+                    break;
+
+                case CONTROL_REBOOT:
+                    _tprintf(TEXT("%-60s: %s\n"),device->instanceId,result->strReboot);
+                    result->reboot = TRUE;
+                    InterlockedIncrement((LONG volatile *)&result->count);
+                    break;
+
+                default:
+                    _tprintf(TEXT("%-60s: %s\n"),device->instanceId,result->strSuccess);
+                    InterlockedIncrement((LONG volatile *)&result->count);
+                    break;
+            }
+        }
+
+        if(devs != INVALID_HANDLE_VALUE) {
+            SetupDiDestroyDeviceInfoList(devs);
+        }
+    }
+    return 0;
+}
+
+int cmdBatch(_In_ LPCTSTR BaseName, _In_opt_ LPCTSTR Machine, _In_ DWORD Flags, _In_ int argc, _In_reads_(argc) PTSTR argv[])
+/*++
+
+Routine Description:
+
+    BATCH [-j:<n>] <file>
+    each line of <file> is one of
+    enable|disable|restart <id> [<id>...]
+    enable|disable|restart =<class> [<id>...]
+    blank lines and lines starting with ';' are ignored
+
+    devices are enumerated once and every line is matched against that
+    list with EnumerateDeviceSet, then the queued operations are run by
+    up to <n> worker threads. Operations on the same device run in file
+    order on one thread, different devices run in parallel.
+
+Arguments:
+
+    BaseName  - name of executable
+    Machine   - must be NULL (local machine only)
+    argc/argv - remaining parameters
+
+Return Value:
+
+    EXIT_xxxx (EXIT_REBOOT if reboot is required)
+
+--*/
+{
+    BatchContext context;
+    HDEVINFO devs = INVALID_HANDLE_VALUE;
+    FILE *file = NULL;
+    TCHAR line[BATCH_MAX_LINE];
+    LPTSTR lineArgv[BATCH_MAX_ARGS];
+    int lineArgc;
+    LPTSTR token;
+    LPTSTR nextToken = NULL;
+    DWORD lineNumber = 0;
+    HANDLE threads[BATCH_MAX_WORKERS];
+    int workers = BATCH_DEFAULT_WORKERS;
+    int numThreads = 0;
+    DWORD numOps = 0;
+    DWORD numBusy = 0;
+    ULONGLONG start;
+    BOOL reboot = FALSE;
+    BatchOp *op;
+    DWORD index;
+    int i;
+    int failcode = EXIT_FAIL;
+
+    UNREFERENCED_PARAMETER(Flags);
+
+    ZeroMemory(&context,sizeof(context));
+
+    if(Machine) {
+        //
+        // must be local machine as we need to involve class/co installers
+        //
+        return EXIT_USAGE;
+    }
+    if(argc && ((argv[0][0]==TEXT('-')) || (argv[0][0]==TEXT('/'))) &&
+       ((argv[0][1]==TEXT('j')) || (argv[0][1]==TEXT('J'))) && (argv[0][2]==TEXT(':'))) {
+        workers = _ttoi(argv[0]+3);
+        if((workers < 1) || (workers > BATCH_MAX_WORKERS)) {
+            return EXIT_USAGE;
+        }
+        argc--;
+        argv++;
+    }
+    if(argc != 1) {
+        return EXIT_USAGE;
+    }
+
+    for(i=0;i<BATCH_OPS;i++) {
+        if(!LoadString(NULL,BatchOps[i].idsSuccess,context.strings[i][0],ARRAYSIZE(context.strings[i][0])) ||
+           !LoadString(NULL,BatchOps[i].idsReboot,context.strings[i][1],ARRAYSIZE(context.strings[i][1])) ||
+           !LoadString(NULL,BatchOps[i].idsFail,context.strings[i][2],ARRAYSIZE(context.strings[i][2]))) {
+            return EXIT_FAIL;
+        }
+        context.results[i].control = BatchOps[i].control;
+        context.results[i].strSuccess = context.strings[i][0];
+        context.results[i].strReboot = context.strings[i][1];
+        context.results[i].strFail = context.strings[i][2];
+    }
+
+    if(_tfopen_s(&file,argv[0],TEXT("rt")) != 0) {
+        file = NULL;
+        goto final;
+    }
+
+    //
+    // enumerate once for the whole file
+    //
+    devs = SetupDiGetClassDevsEx(NULL,NULL,NULL,DIGCF_ALLCLASSES|DIGCF_PRESENT,NULL,NULL,NULL);
+    if(devs == INVALID_HANDLE_VALUE) {
+        goto final;
+    }
+
+    //
+    // parse the whole file before changing anything, so that a bad line
+    // leaves the system untouched
+    //
+    while(_fgetts(line,ARRAYSIZE(line),file)) {
+        lineNumber++;
+        lineArgc = 0;
+        for(token = _tcstok_s(line,TEXT(" \t\r\n"),&nextToken);token;token = _tcstok_s(NULL,TEXT(" \t\r\n"),&nextToken)) {
+            if(lineArgc == BATCH_MAX_ARGS) {
+                FormatToStream(stderr,MSG_BATCH_BAD_LINE,argv[0],lineNumber);
+                goto final;
+            }
+            lineArgv[lineArgc++] = token;
+        }
+        if(!lineArgc || (lineArgv[0][0] == TEXT(';'))) {
+            continue;
+        }
+        for(context.op=0;context.op<BATCH_OPS;context.op++) {
+            if(_tcsicmp(lineArgv[0],BatchOps[context.op].cmd)==0) {
+                break;
+            }
+        }
+        if((context.op == BATCH_OPS) || (lineArgc < 2)) {
+            FormatToStream(stderr,MSG_BATCH_BAD_LINE,argv[0],lineNumber);
+            goto final;
+        }
+        context.matched = 0;
+        if(EnumerateDeviceSet(devs,lineArgc-1,lineArgv+1,BatchCollectCallback,&context) != EXIT_OK) {
+            goto final;
+        }
+        if(!context.matched) {
+            FormatToStream(stdout,MSG_BATCH_NO_MATCH,lineNumber);
+        }
+    }
+    if(ferror(file)) {
+        goto final;
+    }
+
+    for(index=0;index<context.numDevices;index++) {
+        if(context.devices[index].first) {
+            numBusy++;
+            for(op = context.devices[index].first;op;op = op->next) {
+                numOps++;
+            }
+        }
+    }
+    if((DWORD)workers > numBusy) {
+        workers = numBusy ? (int)numBusy : 1;
+    }
+
+    start = GetTickCount64();
+    for(i=0;i<workers;i++) {
+        threads[numThreads] = CreateThread(NULL,0,BatchWorker,&context,0,NULL);
+        if(!threads[numThreads]) {
+            break;
+        }
+        numThreads++;
+    }
+    if(numThreads) {
+        WaitForMultipleObjects(numThreads,threads,TRUE,INFINITE);
+        for(i=0;i<numThreads;i++) {
+            CloseHandle(threads[i]);
+        }
+    } else {
+        //
+        // couldn't create any threads, do the work here
+        //
+        BatchWorker(&context);
+        numThreads = 1;
+    }
+
+    for(i=0;i<BATCH_OPS;i++) {
+        if(!context.results[i].count) {
+            continue;
+        }
+        if(context.results[i].reboot) {
+            FormatToStream(stdout,BatchOps[i].msgTailReboot,context.results[i].count);
+            reboot = TRUE;
+        } else {
+            FormatToStream(stdout,BatchOps[i].msgTail,context.results[i].count);
+        }
+    }
+    if(!numOps) {
+        FormatToStream(stdout,MSG_FIND_TAIL_NONE_LOCAL);
+    } else {
+        FormatToStream(stdout,MSG_BATCH_TAIL,numOps,numBusy,(DWORD)(GetTickCount64()-start),numThreads);
+    }
+    failcode = reboot ? EXIT_REBOOT : EXIT_OK;
+
+final:
+    if(file) {
+        fclose(file);
+    }
+    if(context.devices) {
+        for(index=0;index<context.numDevices;index++) {
+            while(context.devices[index].first) {
+                op = context.devices[index].first;
+                context.devices[index].first = op->next;
+                delete op;
+            }
+        }
+        delete [] context.devices;
+    }
+    if(devs != INVALID_HANDLE_VALUE) {
+        SetupDiDestroyDeviceInfoList(devs);
+    }
+    return failcode;
+}
+
 int cmdReboot(_In_ LPCTSTR BaseName, _In_opt_ LPCTSTR Machine, _In_ DWORD Flags, _In_ int argc, _In_reads_(argc) PTSTR argv[])
 /*++
 
@@ -2375,12 +2906,14 @@ final:
 
 
 DispatchEntry DispatchTable[] = {
+    { TEXT("batch"),        cmdBatch,       MSG_BATCH_SHORT,       MSG_BATCH_LONG },
     { TEXT("classfilter"),  cmdClassFilter, MSG_CLASSFILTER_SHORT, MSG_CLASSFILTER_LONG },
     { TEXT("classes"),      cmdClasses,     MSG_CLASSES_SHORT,     MSG_CLASSES_LONG },
     { TEXT("disable"),      cmdDisable,     MSG_DISABLE_SHORT,     MSG_DISABLE_LONG },
     { TEXT("driverfiles"),  cmdDriverFiles, MSG_DRIVERFILES_SHORT, MSG_DRIVERFILES_LONG },
     { TEXT("drivernodes"),  cmdDriverNodes, MSG_DRIVERNODES_SHORT, MSG_DRIVERNODES_LONG },
     { TEXT("enable"),       cmdEnable,      MSG_ENABLE_SHORT,      MSG_ENABLE_LONG },
+    { TEXT("export"),       cmdExport,      MSG_EXPORT_SHORT,      MSG_EXPORT_LONG },
     { TEXT("find"),         cmdFind,        MSG_FIND_SHORT,        MSG_FIND_LONG },
     { TEXT("findall"),      cmdFindAll,     MSG_FINDALL_SHORT,     MSG_FINDALL_LONG },
     { TEXT("help"),         cmdHelp,        MSG_HELP_SHORT,        0 },
@@ -789,6 +789,67 @@ Return Value:
     return FALSE;
 }
 
+BOOL MatchDevice(_In_ HDEVINFO Devs, _In_ PSP_DEVINFO_DATA DevInfo, _In_opt_ HANDLE RemoteMachine, _In_ int Count, _In_reads_(Count) const IdEntry * Templ)
+/*++
+
+Routine Description:
+
+    Determine if a device matches any of a list of id's
+
+Arguments:
+
+    Devs    )_ uniquely identify the device
+    DevInfo )
+    RemoteMachine - machine handle from SetupDiGetDeviceInfoListDetail
+    Count/Templ   - id's to match against
+
+Return Value:
+
+    TRUE if any id matches, otherwise FALSE
+
+--*/
+{
+    TCHAR devID[MAX_DEVICE_ID_LEN];
+    LPTSTR *hwIds = NULL;
+    LPTSTR *compatIds = NULL;
+    BOOL match = FALSE;
+    int argIndex;
+
+    //
+    // determine instance ID
+    //
+    if(CM_Get_Device_ID_Ex(DevInfo->DevInst,devID,MAX_DEVICE_ID_LEN,0,RemoteMachine)!=CR_SUCCESS) {
+        devID[0] = TEXT('\0');
+    }
+
+    for(argIndex=0;(argIndex<Count) && !match;argIndex++) {
+        if(Templ[argIndex].InstanceId) {
+            //
+            // match on the instance ID
+            //
+            if(WildCardMatch(devID,Templ[argIndex])) {
+                match = TRUE;
+            }
+        } else {
+            //
+            // determine hardware ID's (only once per device)
+            // and search for matches
+            //
+            if(!hwIds && !compatIds) {
+                hwIds = GetDevMultiSz(Devs,DevInfo,SPDRP_HARDWAREID);
+                compatIds = GetDevMultiSz(Devs,DevInfo,SPDRP_COMPATIBLEIDS);
+            }
+            if(WildCompareHwIds(hwIds,Templ[argIndex]) ||
+                WildCompareHwIds(compatIds,Templ[argIndex])) {
+                match = TRUE;
+            }
+        }
+    }
+    DelMultiSz(hwIds);
+    DelMultiSz(compatIds);
+    return match;
+}
+
 bool SplitCommandLine(
     _In_ int & argc, 
     _In_reads_(argc) LPTSTR * & argv, 
@@ -977,40 +1038,7 @@ Return Value:
     for(devIndex=0;SetupDiEnumDeviceInfo(devs,devIndex,&devInfo);devIndex++) {
 
         if(doSearch) {
-            for(argIndex=skip,match=FALSE;(argIndex<argc) && !match;argIndex++) {
-                TCHAR devID[MAX_DEVICE_ID_LEN];
-                LPTSTR *hwIds = NULL;
-                LPTSTR *compatIds = NULL;
-                //
-                // determine instance ID
-                //
-                if(CM_Get_Device_ID_Ex(devInfo.DevInst,devID,MAX_DEVICE_ID_LEN,0,devInfoListDetail.RemoteMachineHandle)!=CR_SUCCESS) {
-                    devID[0] = TEXT('\0');
-                }
-
-                if(templ[argIndex].InstanceId) {
-                    //
-                    // match on the instance ID
-                    //
-                    if(WildCardMatch(devID,templ[argIndex])) {
-                        match = TRUE;
-                    }
-                } else {
-                    //
-                    // determine hardware ID's
-                    // and search for matches
-                    //
-                    hwIds = GetDevMultiSz(devs,&devInfo,SPDRP_HARDWAREID);
-                    compatIds = GetDevMultiSz(devs,&devInfo,SPDRP_COMPATIBLEIDS);
-
-                    if(WildCompareHwIds(hwIds,templ[argIndex]) ||
-                        WildCompareHwIds(compatIds,templ[argIndex])) {
-                        match = TRUE;
-                    }
-                }
-                DelMultiSz(hwIds);
-                DelMultiSz(compatIds);
-            }
+            match = MatchDevice(devs,&devInfo,devInfoListDetail.RemoteMachineHandle,argc-skip,templ+skip);
         } else {
             match = TRUE;
         }
@@ -1036,6 +1064,116 @@ final:
 
 }
 
+int EnumerateDeviceSet(_In_ HDEVINFO Devs, _In_ int argc, _In_reads_(argc) PWSTR* argv, _In_ CallbackFunc Callback, _In_ LPVOID Context)
+/*++
+
+Routine Description:
+
+    Variation of EnumerateDevices that matches against a device info list
+    the caller has already enumerated, so that many commands can share
+    a single enumeration. Accepts the same arguments:
+    <id> [<id>...]
+    =<class> [<id>...]
+    Explicit instance id's that are not in the list are added to it, so
+    this must not be called while another thread is using Devs.
+
+Arguments:
+
+    Devs     - device info list obtained by caller (local machine)
+    argc/argv - <id>'s to match
+    Callback - function to call for each hit
+    Context  - data to pass function for each hit
+
+Return Value:
+
+    EXIT_xxxx
+
+--*/
+{
+    IdEntry * templ = NULL;
+    int failcode = EXIT_FAIL;
+    int retcode;
+    int argIndex;
+    DWORD devIndex;
+    SP_DEVINFO_DATA devInfo;
+    SP_DEVINFO_LIST_DETAIL_DATA devInfoListDetail;
+    BOOL match;
+    BOOL all = FALSE;
+    GUID cls;
+    DWORD numClass = 0;
+    int skip = 0;
+
+    if(!argc) {
+        return EXIT_USAGE;
+    }
+
+    templ = new IdEntry[argc];
+    if(!templ) {
+        goto final;
+    }
+
+    if(argv[skip][0]==CLASS_PREFIX_CHAR && argv[skip][1]) {
+        if(!SetupDiClassGuidsFromNameEx(argv[skip]+1,&cls,1,&numClass,NULL,NULL) &&
+            GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+            goto final;
+        }
+        if(!numClass) {
+            failcode = EXIT_OK;
+            goto final;
+        }
+        skip++;
+    }
+    if(argc>skip && argv[skip][0]==WILD_CHAR && !argv[skip][1]) {
+        all = TRUE;
+        skip++;
+    } else if(argc<=skip) {
+        all = TRUE;
+    }
+
+    for(argIndex=skip;argIndex<argc;argIndex++) {
+        templ[argIndex] = GetIdType(argv[argIndex]);
+        if(templ[argIndex].InstanceId) {
+            //
+            // pick up non-present devices named explicitly
+            //
+            SetupDiOpenDeviceInfo(Devs,templ[argIndex].String,NULL,0,NULL);
+        }
+    }
+
+    devInfoListDetail.cbSize = sizeof(devInfoListDetail);
+    if(!SetupDiGetDeviceInfoListDetail(Devs,&devInfoListDetail)) {
+        goto final;
+    }
+
+    devInfo.cbSize = sizeof(devInfo);
+    for(devIndex=0;SetupDiEnumDeviceInfo(Devs,devIndex,&devInfo);devIndex++) {
+
+        if(numClass && !IsEqualGUID(devInfo.ClassGuid,cls)) {
+            continue;
+        }
+        if(all) {
+            match = TRUE;
+        } else {
+            match = MatchDevice(Devs,&devInfo,devInfoListDetail.RemoteMachineHandle,argc-skip,templ+skip);
+        }
+        if(match) {
+            retcode = Callback(Devs,&devInfo,devIndex,Context);
+            if(retcode) {
+                failcode = retcode;
+                goto final;
+            }
+        }
+    }
+
+    failcode = EXIT_OK;
+
+final:
+    if(templ) {
+        delete [] templ;
+    }
+    return failcode;
+}
+
 int
 __cdecl
 _tmain(_In_ int argc, _In_reads_(argc) PWSTR* argv)
@@ -68,6 +68,7 @@ bool SplitCommandLine(
     _Out_ int & argc_right, 
     _Outref_result_buffer_(argc_right) LPTSTR * & argv_right);
 int EnumerateDevices(_In_ LPCTSTR BaseName, _In_opt_ LPCTSTR Machine, _In_ DWORD Flags, _In_ int argc, _In_reads_(argc) PWSTR* argv, _In_ CallbackFunc Callback, _In_ LPVOID Context);
+int EnumerateDeviceSet(_In_ HDEVINFO Devs, _In_ int argc, _In_reads_(argc) PWSTR* argv, _In_ CallbackFunc Callback, _In_ LPVOID Context);
 LPTSTR GetDeviceStringProperty(_In_ HDEVINFO Devs, _In_ PSP_DEVINFO_DATA DevInfo, _In_ DWORD Prop);
 LPTSTR GetDeviceDescription(_In_ HDEVINFO Devs, _In_ PSP_DEVINFO_DATA DevInfo);
 __drv_allocatesMem(object) LPTSTR * GetDevMultiSz(_In_ HDEVINFO Devs, _In_ PSP_DEVINFO_DATA DevInfo, _In_ DWORD Prop);
@@ -90,6 +91,26 @@ BOOL DumpDeviceStack(_In_ HDEVINFO Devs, _In_ PSP_DEVINFO_DATA DevInfo);
 BOOL DumpDriverPackageData(_In_ LPCTSTR InfName);
 BOOL Reboot();
 
+//
+// devcon export state, buffers are reused for every device
+//
+#define EXPORT_FORMAT_JSON 0
+#define EXPORT_FORMAT_CSV  1
+
+struct ExportContext {
+    int     Format;     // EXPORT_FORMAT_xxxx
+    DWORD   Count;      // devices written so far
+    PBYTE   Value;      // property value buffer
+    ULONG   ValueSize;
+    LPTSTR  Text;       // record being built
+    size_t  TextSize;
+    size_t  TextUsed;
+};
+
+BOOL ExportHeader(_Inout_ ExportContext * Context);
+BOOL ExportDevice(_Inout_ ExportContext * Context, _In_ HDEVINFO Devs, _In_ PSP_DEVINFO_DATA DevInfo);
+BOOL ExportFooter(_Inout_ ExportContext * Context);
+
 
 //
 // UpdateDriverForPlugAndPlayDevices
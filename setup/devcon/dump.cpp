@@ -14,6 +14,8 @@ Abstract:
 --*/
 
 #include "devcon.h"
+#include <initguid.h>
+#include <devpkey.h>
 
 BOOL DumpDeviceWithInfo(_In_ HDEVINFO Devs, _In_ PSP_DEVINFO_DATA DevInfo, _In_opt_ LPCTSTR Info)
 /*++
@@ -1325,4 +1327,366 @@ failed:
     return (Err == NO_ERROR);
 }
 
+//
+// properties written by ExportDevice, in output order
+//
+static const struct {
+    LPCTSTR           Name;
+    const DEVPROPKEY *Key;
+} ExportProperties[] = {
+    { TEXT("InstanceId"),    &DEVPKEY_Device_InstanceId },
+    { TEXT("Description"),   &DEVPKEY_Device_DeviceDesc },
+    { TEXT("FriendlyName"),  &DEVPKEY_Device_FriendlyName },
+    { TEXT("Manufacturer"),  &DEVPKEY_Device_Manufacturer },
+    { TEXT("Class"),         &DEVPKEY_Device_Class },
+    { TEXT("ClassGuid"),     &DEVPKEY_Device_ClassGuid },
+    { TEXT("HardwareIds"),   &DEVPKEY_Device_HardwareIds },
+    { TEXT("CompatibleIds"), &DEVPKEY_Device_CompatibleIds },
+    { TEXT("Service"),       &DEVPKEY_Device_Service },
+    { TEXT("DriverInfPath"), &DEVPKEY_Device_DriverInfPath },
+    { TEXT("DriverVersion"), &DEVPKEY_Device_DriverVersion },
+    { TEXT("LocationInfo"),  &DEVPKEY_Device_LocationInfo },
+    { TEXT("Parent"),        &DEVPKEY_Device_Parent },
+    { TEXT("DevNodeStatus"), &DEVPKEY_Device_DevNodeStatus },
+    { TEXT("ProblemCode"),   &DEVPKEY_Device_ProblemCode },
+};
+
+static BOOL ExportAppend(_Inout_ ExportContext * Context, _In_reads_(Length) LPCTSTR Text, _In_ size_t Length)
+/*++
+
+Routine Description:
+
+    Append text to the record being built, growing the record buffer
+    the buffer is kept for the next record
+
+Arguments:
+
+    Context - export state
+    Text    - text to append
+    Length  - characters in Text
+
+Return Value:
+
+    TRUE if appended
+
+--*/
+{
+    if(Context->TextUsed+Length+1 > Context->TextSize) {
+        size_t size = Context->TextSize ? Context->TextSize*2 : 4096;
+        LPTSTR text;
+
+        while(size < Context->TextUsed+Length+1) {
+            size *= 2;
+        }
+        text = new TCHAR[size];
+        if(!text) {
+            return FALSE;
+        }
+        if(Context->Text) {
+            CopyMemory(text,Context->Text,Context->TextUsed*sizeof(TCHAR));
+            delete [] Context->Text;
+        }
+        Context->Text = text;
+        Context->TextSize = size;
+    }
+    CopyMemory(Context->Text+Context->TextUsed,Text,Length*sizeof(TCHAR));
+    Context->TextUsed += Length;
+    Context->Text[Context->TextUsed] = TEXT('\0');
+    return TRUE;
+}
+
+static BOOL ExportAppendString(_Inout_ ExportContext * Context, _In_ LPCTSTR Text)
+/*++
+
+Routine Description:
+
+    Append a NUL-terminated string to the record being built
+
+Arguments:
+
+    Context - export state
+    Text    - text to append
+
+Return Value:
+
+    TRUE if appended
+
+--*/
+{
+    return ExportAppend(Context,Text,lstrlen(Text));
+}
+
+static BOOL ExportAppendEscaped(_Inout_ ExportContext * Context, _In_ LPCTSTR Text)
+/*++
+
+Routine Description:
+
+    Append a string value, escaped for the output format
+    (the caller adds the surrounding quotes)
+    runs of characters that need no escaping are copied in one go
+
+Arguments:
+
+    Context - export state
+    Text    - value to append
+
+Return Value:
+
+    TRUE if appended
+
+--*/
+{
+    LPCTSTR run = Text;
+    TCHAR escape[8];
+
+    for(;*Text;Text++) {
+        if(Context->Format == EXPORT_FORMAT_CSV) {
+            if(*Text != TEXT('"')) {
+                continue;
+            }
+            StringCchCopy(escape,ARRAYSIZE(escape),TEXT("\"\""));
+        } else {
+            if((*Text != TEXT('"')) && (*Text != TEXT('\\')) && (*Text >= TEXT(' '))) {
+                continue;
+            }
+            if(*Text < TEXT(' ')) {
+                StringCchPrintf(escape,ARRAYSIZE(escape),TEXT("\\u%04x"),(unsigned)*Text);
+            } else {
+                escape[0] = TEXT('\\');
+                escape[1] = *Text;
+                escape[2] = TEXT('\0');
+            }
+        }
+        if(!ExportAppend(Context,run,Text-run) || !ExportAppendString(Context,escape)) {
+            return FALSE;
+        }
+        run = Text+1;
+    }
+    return ExportAppend(Context,run,Text-run);
+}
+
+static BOOL ExportAppendValue(_Inout_ ExportContext * Context, _In_ DEVPROPTYPE Type, _In_reads_bytes_(Size) PBYTE Value, _In_ ULONG Size)
+/*++
+
+Routine Description:
+
+    Append a property value
+    strings are quoted, string lists become a JSON array or
+    a ';'-separated CSV field, numbers are written as-is
+    types that aren't understood are written as a missing value
+
+Arguments:
+
+    Context - export state
+    Type    - DEVPROP_TYPE_xxxx returned with the value
+    Value   - value
+    Size    - bytes in Value
+
+Return Value:
+
+    TRUE if appended
+
+--*/
+{
+    BOOL json = (Context->Format == EXPORT_FORMAT_JSON);
+    TCHAR number[40];
+    LPCTSTR item;
+    BOOL first;
+
+    switch(Type) {
+        case DEVPROP_TYPE_STRING:
+            return ExportAppendString(Context,TEXT("\"")) &&
+                   ExportAppendEscaped(Context,(LPCTSTR)Value) &&
+                   ExportAppendString(Context,TEXT("\""));
+
+        case DEVPROP_TYPE_STRING_LIST:
+            if(!ExportAppendString(Context,json ? TEXT("[") : TEXT("\""))) {
+                return FALSE;
+            }
+            for(item = (LPCTSTR)Value,first = TRUE;*item;item += lstrlen(item)+1,first = FALSE) {
+                if(!first && !ExportAppendString(Context,json ? TEXT(",") : TEXT(";"))) {
+                    return FALSE;
+                }
+                if((json && !ExportAppendString(Context,TEXT("\""))) ||
+                   !ExportAppendEscaped(Context,item) ||
+                   (json && !ExportAppendString(Context,TEXT("\"")))) {
+                    return FALSE;
+                }
+            }
+            return ExportAppendString(Context,json ? TEXT("]") : TEXT("\""));
+
+        case DEVPROP_TYPE_GUID:
+            if(Size < sizeof(GUID) || !StringFromGUID2(*(GUID*)Value,number,ARRAYSIZE(number))) {
+                break;
+            }
+            return ExportAppendString(Context,TEXT("\"")) &&
+                   ExportAppendString(Context,number) &&
+                   ExportAppendString(Context,TEXT("\""));
+
+        case DEVPROP_TYPE_UINT32:
+            if(Size < sizeof(ULONG)) {
+                break;
+            }
+            StringCchPrintf(number,ARRAYSIZE(number),TEXT("%lu"),*(ULONG*)Value);
+            return ExportAppendString(Context,number);
+
+        case DEVPROP_TYPE_BOOLEAN:
+            if(Size < sizeof(DEVPROP_BOOLEAN)) {
+                break;
+            }
+            return ExportAppendString(Context,*(DEVPROP_BOOLEAN*)Value ? TEXT("true") : TEXT("false"));
+
+        default:
+            break;
+    }
+    return json ? ExportAppendString(Context,TEXT("null")) : TRUE;
+}
+
+BOOL ExportHeader(_Inout_ ExportContext * Context)
+/*++
+
+Routine Description:
+
+    Write what comes before the first device:
+    the opening bracket for JSON, or the column names for CSV
+
+Arguments:
+
+    Context - export state
+
+Return Value:
+
+    TRUE if written
+
+--*/
+{
+    DWORD prop;
+
+    if(Context->Format == EXPORT_FORMAT_JSON) {
+        return _fputts(TEXT("["),stdout) >= 0;
+    }
+    Context->TextUsed = 0;
+    for(prop=0;prop<ARRAYSIZE(ExportProperties);prop++) {
+        if(!ExportAppendString(Context,prop ? TEXT(",") : TEXT("")) ||
+           !ExportAppendString(Context,ExportProperties[prop].Name)) {
+            return FALSE;
+        }
+    }
+    return ExportAppendString(Context,TEXT("\n")) && (_fputts(Context->Text,stdout) >= 0);
+}
+
+BOOL ExportDevice(_Inout_ ExportContext * Context, _In_ HDEVINFO Devs, _In_ PSP_DEVINFO_DATA DevInfo)
+/*++
+
+Routine Description:
+
+    Write one device as a JSON object or a CSV row
+    every property is read with CM_Get_DevNode_Property into a buffer
+    that is reused for all devices, and the record is written to stdout
+    in a single call so output streams while devices are enumerated
+
+Arguments:
+
+    Context - export state
+    Devs    )_ uniquely identify device
+    DevInfo )
+
+Return Value:
+
+    TRUE if written
+
+--*/
+{
+    BOOL json = (Context->Format == EXPORT_FORMAT_JSON);
+    DEVPROPTYPE type;
+    ULONG size;
+    CONFIGRET cr;
+    DWORD prop;
+
+    UNREFERENCED_PARAMETER(Devs);
+
+    Context->TextUsed = 0;
+    if(json && !ExportAppendString(Context,Context->Count ? TEXT(",\n{") : TEXT("\n{"))) {
+        return FALSE;
+    }
+
+    for(prop=0;prop<ARRAYSIZE(ExportProperties);prop++) {
+        if(prop && !ExportAppendString(Context,TEXT(","))) {
+            return FALSE;
+        }
+        if(json && (!ExportAppendString(Context,TEXT("\"")) ||
+                    !ExportAppendString(Context,ExportProperties[prop].Name) ||
+                    !ExportAppendString(Context,TEXT("\":")))) {
+            return FALSE;
+        }
+
+        //
+        // leave room for a terminating pair of NULs so a truncated
+        // string or string list is still safe to walk
+        //
+        size = Context->ValueSize > 2*sizeof(TCHAR) ? Context->ValueSize-2*sizeof(TCHAR) : 0;
+        cr = CM_Get_DevNode_Property(DevInfo->DevInst,ExportProperties[prop].Key,&type,Context->Value,&size,0);
+        if(cr == CR_BUFFER_SMALL) {
+            PBYTE value = new BYTE[size+2*sizeof(TCHAR)];
+            if(!value) {
+                return FALSE;
+            }
+            delete [] Context->Value;
+            Context->Value = value;
+            Context->ValueSize = size+2*sizeof(TCHAR);
+            cr = CM_Get_DevNode_Property(DevInfo->DevInst,ExportProperties[prop].Key,&type,Context->Value,&size,0);
+        }
+        if(cr == CR_SUCCESS) {
+            ZeroMemory(Context->Value+size,2*sizeof(TCHAR));
+        } else {
+            type = DEVPROP_TYPE_EMPTY;
+            size = 0;
+        }
+        if(!ExportAppendValue(Context,type,Context->Value,size)) {
+            return FALSE;
+        }
+    }
+    if(!ExportAppendString(Context,json ? TEXT("}") : TEXT("\n"))) {
+        return FALSE;
+    }
+    Context->Count++;
+    return _fputts(Context->Text,stdout) >= 0;
+}
+
+BOOL ExportFooter(_Inout_ ExportContext * Context)
+/*++
+
+Routine Description:
+
+    Write what comes after the last device and release the buffers
+
+Arguments:
+
+    Context - export state
+
+Return Value:
+
+    TRUE if written
+
+--*/
+{
+    BOOL b = TRUE;
+
+    if(Context->Format == EXPORT_FORMAT_JSON) {
+        b = _fputts(TEXT("\n]\n"),stdout) >= 0;
+    }
+    if(fflush(stdout) != 0) {
+        b = FALSE;
+    }
+    if(Context->Text) {
+        delete [] Context->Text;
+        Context->Text = NULL;
+    }
+    if(Context->Value) {
+        delete [] Context->Value;
+        Context->Value = NULL;
+    }
+    return b;
+}
+
 
@@ -514,11 +514,16 @@ Return Value:
 {
     NTSTATUS    NTStatus = STATUS_SUCCESS;
     ULONG           IOBytes;
+    PREADER_EXTENSION   ReaderExtension = SmartcardExtension->ReaderExtension;
+    LARGE_INTEGER   StartTime, EndTime, Frequency;
+    ULONGLONG       Ticks;
 
     SmartcardDebug(
                   DEBUG_TRACE,
                   ( "PSCR!CBT1Transmit: Enter\n" )
                   );
+
+    StartTime = KeQueryPerformanceCounter( NULL );
         //
         //      use the lib support to construct the T=1 packets
         //
@@ -590,11 +595,43 @@ Return Value:
             // send a resynch. request in case of a timeout
             //
             NTStatus = SmartcardT1Reply( SmartcardExtension );
+            ReaderExtension->T1Blocks++;
         }
 
         //      continue if the lib wants to send the next packet
     } while ( NTStatus == STATUS_MORE_PROCESSING_REQUIRED );
 
+    //
+    //  account the APDU round trip (all chained blocks, WTX included)
+    //
+    EndTime = KeQueryPerformanceCounter( &Frequency );
+    Ticks = (ULONGLONG)( EndTime.QuadPart - StartTime.QuadPart );
+
+    ReaderExtension->T1Transmissions++;
+    ReaderExtension->T1TotalTicks += Ticks;
+    if ( Ticks > ReaderExtension->T1MaxTicks ) {
+        ReaderExtension->T1MaxTicks = Ticks;
+    }
+
+    if ( ReaderExtension->T1Transmissions >= PSCR_T1_STATS_INTERVAL &&
+         Frequency.QuadPart != 0 ) {
+        SmartcardDebug(
+                      DEBUG_PROTOCOL,
+                      ( "PSCR!CBT1Transmit: %lu APDUs, %lu blocks, avg %I64u us, max %I64u us\n",
+                        ReaderExtension->T1Transmissions,
+                        ReaderExtension->T1Blocks,
+                        ReaderExtension->T1TotalTicks * 1000000 /
+                            ( (ULONGLONG) Frequency.QuadPart * ReaderExtension->T1Transmissions ),
+                        ReaderExtension->T1MaxTicks * 1000000 /
+                            (ULONGLONG) Frequency.QuadPart )
+                      );
+
+        ReaderExtension->T1Transmissions = 0;
+        ReaderExtension->T1Blocks = 0;
+        ReaderExtension->T1TotalTicks = 0;
+        ReaderExtension->T1MaxTicks = 0;
+    }
+
     // start freeze routine, if an interrupt was sent, but no freeze data was read
     if( SmartcardExtension->ReaderExtension->RequestInterrupt )
         PscrFreeze( SmartcardExtension );
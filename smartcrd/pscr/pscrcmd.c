@@ -173,8 +173,21 @@ Return Value:
             // store the size to report to the lib
             //  The maximum buffer size of the reader is to betrieved with
                 //  ((ULONG)InData[ 1 ] << 8) | InData[ 0 ]
+                //  The lib negotiates this IFSD with the card (S(IFS request)),
+                //  so offer the T=1 maximum whenever a whole block (prologue,
+                //  information field and CRC epilogue) fits into the reader buffer.
                 //
-                ReaderExtension->MaxIFSD = 254;
+                ReaderExtension->MaxIFSD = PSCR_T1_IFSD_MAX;
+                if ( Len >= 2 ) {
+                    ULONG ReaderBufferSize =
+                        ((ULONG)InData[ 1 ] << 8) | InData[ 0 ];
+
+                    if (( ReaderBufferSize > PSCR_T1_BLOCK_OVERHEAD ) &&
+                        ( ReaderBufferSize - PSCR_T1_BLOCK_OVERHEAD < PSCR_T1_IFSD_MAX )) {
+                        ReaderExtension->MaxIFSD =
+                            ReaderBufferSize - PSCR_T1_BLOCK_OVERHEAD;
+                    }
+                }
 
             //
             // let the reader process the size write command
@@ -65,6 +65,17 @@ _Analysis_mode_(_Analysis_code_type_kernel_driver_)
 #define DELAY_WRITE_PSCR_REG    1
 #define DELAY_PSCR_WAIT         5
 
+//
+//  PscrWait polls the status register PSCR_SPIN_POLLS times, DELAY_PSCR_SPIN_US
+//  apart, before it falls back to sleeping DELAY_PSCR_WAIT ms between polls.
+//  Most short T=1 blocks are answered within that first millisecond.
+//
+#define PSCR_SPIN_POLLS         100
+#define DELAY_PSCR_SPIN_US      10
+
+//  number of T=1 transmissions between two round-trip statistics traces
+#define PSCR_T1_STATS_INTERVAL  64
+
 #define LOBYTE( any )   ((UCHAR)( any & 0xFF ) )
 #define HIBYTE( any )   ((UCHAR)( ( any >> 8) & 0xFF ))
 
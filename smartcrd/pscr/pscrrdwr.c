@@ -242,11 +242,11 @@ Return Value:
     if( NT_SUCCESS( NTStatus = PscrWait( ReaderExtension, PSCR_DATA_AVAIL_BIT | PSCR_FREE_BIT )))
     {
 
-        //    take control over
+        //    take control over; the reader needs the same settle time as
+        //    for any other register write (PscrWait already saw it idle)
 
-        SysDelay( DELAY_PSCR_WAIT );
         WRITE_PORT_UCHAR( &IOBase->CmdStatusReg, PSCR_HOST_CONTROL_BIT );
-        SysDelay( DELAY_PSCR_WAIT );
+        SysDelay( DELAY_WRITE_PSCR_REG );
 
         //    get number of available bytes
         InDataLen = ( READ_PORT_UCHAR( &IOBase->SizeMSReg ) << 8 );
@@ -464,6 +464,9 @@ PscrWait:
     MaxRetries * DELAY_PSCR_WAIT if MaxRetries != 0.
     If MaxRetries = 0 the driver waits until the requested status is reported or the
     user defines a timeout.
+    The status is first polled PSCR_SPIN_POLLS times without sleeping, so that a
+    fast reply is not delayed by a full DELAY_PSCR_WAIT period. The spin phase is
+    not counted against MaxRetries.
 
 Arguments:
     ReaderExtension     context of call
@@ -478,10 +481,28 @@ Return Value:
     NTSTATUS        NTStatus;
     PPSCR_REGISTERS IOBase;
     ULONG           Retries;
+    UCHAR           Status;
 
     IOBase      = ReaderExtension->IOBase;
     NTStatus    = STATUS_DEVICE_BUSY;
 
+    //  short busy wait for replies that are already on their way
+    for ( Retries = 0; Retries < PSCR_SPIN_POLLS; Retries++) {
+
+        Status = READ_PORT_UCHAR( &IOBase->CmdStatusReg );
+
+        if (( Status == 0x01 ) && ReaderExtension->InvalidStatus ) {
+            (void) READ_PORT_UCHAR( &IOBase->CmdStatusReg );
+            return STATUS_CANCELLED;
+        }
+
+        if (( Status & Mask ) == Mask ) {
+            (void) READ_PORT_UCHAR( &IOBase->CmdStatusReg );
+            return STATUS_SUCCESS;
+        }
+        KeStallExecutionProcessor( DELAY_PSCR_SPIN_US );
+    }
+
     //  wait until condition fulfilled or specified timeout expired
     for ( Retries = 0; Retries < ReaderExtension->MaxRetries; Retries++) {
 
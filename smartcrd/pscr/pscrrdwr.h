@@ -114,6 +114,15 @@ typedef struct _READER_EXTENSION {
 
     ULONG                   dataRatesSupported[MAX_DATARATES];
 
+    //
+    //  T=1 round-trip statistics (CBT1Transmit), in performance counter
+    //  ticks; traced every PSCR_T1_STATS_INTERVAL transmissions
+    //
+    ULONG                   T1Transmissions;
+    ULONG                   T1Blocks;
+    ULONGLONG               T1TotalTicks;
+    ULONGLONG               T1MaxTicks;
+
 } READER_EXTENSION, *PREADER_EXTENSION;
 
 #define SIZEOF_READER_EXTENSION     ( sizeof( READER_EXTENSION ))
@@ -144,6 +153,8 @@ typedef struct _READER_EXTENSION {
 #define PCB_DEFAULT                 0x00
 
 #define MAX_T1_BLOCK_SIZE           270
+#define PSCR_T1_IFSD_MAX            254
+#define PSCR_T1_BLOCK_OVERHEAD      ( PSCR_PROLOGUE_LENGTH + PSCR_CRC_LENGTH )
 //
 //  data buffer idx
 //
@@ -20,7 +20,10 @@ Abstract:
     * Initialize the sensor object from ACPI configuration.
     * Configure the hardware buffers and registers.
     * Connect the data notification interrupt.
-    * Set the report interval and change sensitivity properties.
+    * Set the report interval, report latency and change sensitivity
+      properties.
+    * Batch samples in the hardware FIFO and drain them with a single
+      SPB sequence per watermark interrupt.
     * Set the device operation mode (eventing, standby, etc.).
     * Write data to the device's registers.
 
@@ -54,7 +57,7 @@ const REGISTER_SETTING g_ConfigurationSettings[] =
         ADXL345_DATA_FORMAT_FULL_RES |
         ADXL345_DATA_FORMAT_JUSTIFY_RIGHT |
         ADXL345_DATA_FORMAT_RANGE_16G },
-    // No FIFO
+    // No FIFO until batching is requested
     { ADXL345_FIFO_CTL,
         ADXL345_FIFO_CTL_MODE_BYPASS },
     // Data rate set to default
@@ -70,9 +73,10 @@ const REGISTER_SETTING g_ConfigurationSettings[] =
         ADXL345_ACT_INACT_CTL_ACT_X |
         ADXL345_ACT_INACT_CTL_ACT_Y |
         ADXL345_ACT_INACT_CTL_ACT_Z },
-    // Activity interrupt mapped to pin 1
+    // Activity and FIFO watermark interrupts mapped to pin 1
     { ADXL345_INT_MAP,
-        ADXL345_INT_ACTIVITY },
+        ADXL345_INT_ACTIVITY |
+        ADXL345_INT_WATERMARK },
 };
 
 //
@@ -152,7 +156,11 @@ CAccelerometerDevice::CAccelerometerDevice() :
     m_pSpbRequest(nullptr),
     m_pDataBuffer(nullptr),
     m_fInitialized(FALSE),
-    m_InterruptsEnabled(0)
+    m_InterruptsEnabled(0),
+    m_DataRateInterval(_GetDataRateFromReportInterval(DEFAULT_ACCELEROMETER_CURRENT_REPORT_INTERVAL).DataRateInterval),
+    m_ReportLatency(0),
+    m_FifoSamples(0),
+    m_BatchedSampleCount(0)
 {
 
 }
@@ -1202,8 +1210,10 @@ HRESULT CAccelerometerDevice::InitializeRequest(
 
         if (SUCCEEDED(hr))
         {
-            // Create the data buffer
-            m_pDataBuffer = new BYTE[ADXL345_DATA_REPORT_SIZE_BYTES];
+            // Create the data buffer, large enough to
+            // hold a full FIFO worth of samples
+            m_pDataBuffer = new BYTE[
+                ADXL345_FIFO_ENTRIES_MAX * ADXL345_DATA_REPORT_SIZE_BYTES];
 
             if (m_pDataBuffer == nullptr)
             {
@@ -1550,6 +1560,27 @@ HRESULT CAccelerometerDevice::SetDeviceStatePolling()
         {
             m_InterruptsEnabled = pBuffer[0];
         }
+
+        // Bypass the FIFO so that polled reads
+        // return the latest sample
+        if (SUCCEEDED(hr))
+        {
+            pBuffer[0] = ADXL345_FIFO_CTL_MODE_BYPASS;
+            hr = WriteRegister(ADXL345_FIFO_CTL, pBuffer, 1);
+
+            if (FAILED(hr))
+            {
+                Trace(
+                    TRACE_LEVEL_ERROR,
+                    "Failed to bypass the FIFO, %!HRESULT!", 
+                    hr);
+            }
+            else
+            {
+                m_FifoSamples = 0;
+                m_BatchedSampleCount = 0;
+            }
+        }
             
         // Place device in measurement mode
         if (SUCCEEDED(hr))
@@ -1628,23 +1659,11 @@ HRESULT CAccelerometerDevice::SetDeviceStateEventing()
                 hr);
         }
 
-        // Enable activity detection interrupt
+        // Enable activity detection or FIFO watermark
+        // interrupt, depending on the report latency
         if (SUCCEEDED(hr))
         {
-            pBuffer[0] = ADXL345_INT_ACTIVITY;
-            hr = WriteRegister(ADXL345_INT_ENABLE, pBuffer, 1);
-
-            if (FAILED(hr))
-            {
-                Trace(
-                    TRACE_LEVEL_ERROR,
-                    "Failed to enable activity interrupt, %!HRESULT!", 
-                    hr);
-            }
-            else
-            {
-                m_InterruptsEnabled = pBuffer[0];
-            }
+            hr = EnableEventingInterrupts();
         }
     }
 
@@ -1736,6 +1755,8 @@ HRESULT CAccelerometerDevice::SetReportInterval(
                 }
                 else
                 {
+                    m_DataRateInterval = newDataRate.DataRateInterval;
+
                     Trace(
                         TRACE_LEVEL_INFORMATION,
                         "Data rate interval set to %d ms",
@@ -1746,14 +1767,14 @@ HRESULT CAccelerometerDevice::SetReportInterval(
             if (SUCCEEDED(hr))
             {
                 // Reenable interrupts
-                pWriteBuffer[0] = ADXL345_INT_ACTIVITY;
+                pWriteBuffer[0] = m_InterruptsEnabled;
                 hr = WriteRegister(ADXL345_INT_ENABLE, pWriteBuffer, 1);
                 
                 if (FAILED(hr))
                 {
                     Trace(
                         TRACE_LEVEL_ERROR,
-                        "Failed to enable activity interrupt, %!HRESULT!", 
+                        "Failed to reenable interrupts, %!HRESULT!", 
                         hr);
                 }
             }
@@ -1771,6 +1792,59 @@ HRESULT CAccelerometerDevice::SetReportInterval(
     return hr;
 }
 
+/////////////////////////////////////////////////////////////////////////
+//
+//  CAccelerometerDevice::SetReportLatency
+//
+//  This method is used to set the report latency of the device, which
+//  determines how many samples are batched in the FIFO before the
+//  watermark interrupt fires.
+//
+//  Parameters:
+//      ReportLatency - desired report latency, 0 disables batching
+//
+//  Return Values:
+//      status
+//
+/////////////////////////////////////////////////////////////////////////
+HRESULT CAccelerometerDevice::SetReportLatency(
+    _In_  ULONG ReportLatency
+    )
+{
+    FuncEntry();
+
+    HRESULT hr = (m_fInitialized == TRUE) ? S_OK : E_UNEXPECTED;
+
+    if (SUCCEEDED(hr))
+    {
+        // Synchronize access to device
+        auto scopeLock = m_CriticalSection.Lock();
+
+        m_ReportLatency = ReportLatency;
+
+        // Only reprogram the FIFO while eventing and when the
+        // watermark actually changes, since doing so discards
+        // the samples that are already batched.
+        if ((m_InterruptsEnabled != 0) &&
+            (GetFifoSamples() != m_FifoSamples))
+        {
+            hr = EnableEventingInterrupts();
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            Trace(
+                TRACE_LEVEL_INFORMATION,
+                "Report latency set to %lu ms",
+                ReportLatency);
+        }
+    }
+
+    //FuncExit();
+
+    return hr;
+}
+
 /////////////////////////////////////////////////////////////////////////
 //
 //  CAccelerometerDevice::SetChangeSensitivity
@@ -1917,14 +1991,14 @@ HRESULT CAccelerometerDevice::SetChangeSensitivity(
             if (SUCCEEDED(hr))
             {
                 // Reenable interrupts
-                pWriteBuffer[0] = ADXL345_INT_ACTIVITY;
+                pWriteBuffer[0] = m_InterruptsEnabled;
                 hr = WriteRegister(ADXL345_INT_ENABLE, pWriteBuffer, 1);
                 
                 if (FAILED(hr))
                 {
                     Trace(
                         TRACE_LEVEL_ERROR,
-                        "Failed to enable activity interrupt, %!HRESULT!", 
+                        "Failed to reenable interrupts, %!HRESULT!", 
                         hr);
                 }
             }
@@ -2279,12 +2353,22 @@ CAccelerometerDevice::OnInterruptIsr(
                         pAccelerometerDevice->m_InterruptsEnabled);
                 }
             }
+
+            // The watermark interrupt is only cleared once the
+            // FIFO drops below the watermark, so drain it here
+            // rather than in the work item.
+            if (SUCCEEDED(hr) &&
+                ((validInterrupts & ADXL345_INT_WATERMARK) > 0))
+            {
+                hr = pAccelerometerDevice->DrainFifo();
+            }
         }
 
         if (SUCCEEDED(hr))
         {
-            // Confirm that an activity interrupt was fired
-            if ((validInterrupts & ADXL345_INT_ACTIVITY) > 0)
+            // Confirm that an activity or watermark interrupt was fired
+            if ((validInterrupts & 
+                    (ADXL345_INT_ACTIVITY | ADXL345_INT_WATERMARK)) > 0)
             {
                 interruptRecognized = TRUE;
         
@@ -2422,19 +2506,34 @@ HRESULT CAccelerometerDevice::RequestData(
         // Synchronize access to device
         auto scopeLock = m_CriticalSection.Lock();
 
-        // Read the data registers asynchronously
-        hr = ReadRegister(
-            ADXL345_DATA_X0,
-            m_pDataBuffer,
-            ADXL345_DATA_REPORT_SIZE_BYTES,
-            0);
+        BYTE* pSample = m_pDataBuffer;
 
-        if (FAILED(hr))
+        if (m_BatchedSampleCount > 0)
         {
-            Trace(
-                TRACE_LEVEL_ERROR,
-                "Failed to read new data from device, %!HRESULT!",
-                hr);
+            // A batch was drained from the FIFO. The sensor class
+            // extension only reports the current value, so report
+            // the newest sample of the batch.
+            pSample = m_pDataBuffer + 
+                ((m_BatchedSampleCount - 1) * ADXL345_DATA_REPORT_SIZE_BYTES);
+
+            m_BatchedSampleCount = 0;
+        }
+        else
+        {
+            // Read the data registers asynchronously
+            hr = ReadRegister(
+                ADXL345_DATA_X0,
+                m_pDataBuffer,
+                ADXL345_DATA_REPORT_SIZE_BYTES,
+                0);
+
+            if (FAILED(hr))
+            {
+                Trace(
+                    TRACE_LEVEL_ERROR,
+                    "Failed to read new data from device, %!HRESULT!",
+                    hr);
+            }
         }
 
         if (SUCCEEDED(hr))
@@ -2444,9 +2543,9 @@ HRESULT CAccelerometerDevice::RequestData(
             DOUBLE xAccel, yAccel, zAccel;
             const DOUBLE scaleFactor = 1/256.0F;
 
-            xRaw = (SHORT)((m_pDataBuffer[1] << 8) | m_pDataBuffer[0]);
-            yRaw = (SHORT)((m_pDataBuffer[3] << 8) | m_pDataBuffer[2]);
-            zRaw = (SHORT)((m_pDataBuffer[5] << 8) | m_pDataBuffer[4]);
+            xRaw = (SHORT)((pSample[1] << 8) | pSample[0]);
+            yRaw = (SHORT)((pSample[3] << 8) | pSample[2]);
+            zRaw = (SHORT)((pSample[5] << 8) | pSample[4]);
 
             xAccel = (DOUBLE)xRaw * scaleFactor;
             yAccel = (DOUBLE)yRaw * scaleFactor;
@@ -2494,6 +2593,220 @@ HRESULT CAccelerometerDevice::RequestData(
     return hr;
 }
 
+/////////////////////////////////////////////////////////////////////////
+//
+//  CAccelerometerDevice::GetFifoSamples
+//
+//  This method is used to calculate the FIFO watermark from the report
+//  latency and the current data rate.
+//
+//  Parameters:
+//
+//  Return Values:
+//      number of samples to batch, or 0 if samples should not be batched
+//
+/////////////////////////////////////////////////////////////////////////
+BYTE CAccelerometerDevice::GetFifoSamples()
+{
+    ULONG samples = 0;
+
+    if (m_DataRateInterval > 0)
+    {
+        samples = m_ReportLatency / m_DataRateInterval;
+    }
+
+    if (samples > ADXL345_FIFO_CTL_SAMPLES_MASK)
+    {
+        samples = ADXL345_FIFO_CTL_SAMPLES_MASK;
+    }
+
+    // Batching a single sample saves nothing
+    if (samples < 2)
+    {
+        samples = 0;
+    }
+
+    return (BYTE)samples;
+}
+
+/////////////////////////////////////////////////////////////////////////
+//
+//  CAccelerometerDevice::EnableEventingInterrupts
+//
+//  This method is used to configure the FIFO and enable the eventing
+//  interrupt. Without a report latency the activity interrupt is used.
+//  Otherwise the FIFO is placed in stream mode and the watermark
+//  interrupt fires once a batch has been collected. The caller must
+//  hold the device lock.
+//
+//  Parameters:
+//
+//  Return Values:
+//      status
+//
+/////////////////////////////////////////////////////////////////////////
+HRESULT CAccelerometerDevice::EnableEventingInterrupts()
+{
+    FuncEntry();
+
+    BYTE samples = GetFifoSamples();
+    BYTE value = 0;
+
+    // Disable interrupts while the FIFO is reconfigured
+    HRESULT hr = WriteRegister(ADXL345_INT_ENABLE, &value, 1);
+
+    if (FAILED(hr))
+    {
+        Trace(
+            TRACE_LEVEL_ERROR,
+            "Failed to disable interrupts, %!HRESULT!", 
+            hr);
+    }
+    else
+    {
+        m_InterruptsEnabled = value;
+    }
+
+    // Bypass mode clears any stale samples
+    if (SUCCEEDED(hr))
+    {
+        value = ADXL345_FIFO_CTL_MODE_BYPASS;
+        hr = WriteRegister(ADXL345_FIFO_CTL, &value, 1);
+
+        if (SUCCEEDED(hr))
+        {
+            m_FifoSamples = 0;
+            m_BatchedSampleCount = 0;
+        }
+    }
+
+    if (SUCCEEDED(hr) && (samples > 0))
+    {
+        value = ADXL345_FIFO_CTL_MODE_STREAM | samples;
+        hr = WriteRegister(ADXL345_FIFO_CTL, &value, 1);
+
+        if (SUCCEEDED(hr))
+        {
+            m_FifoSamples = samples;
+        }
+    }
+
+    if (FAILED(hr))
+    {
+        Trace(
+            TRACE_LEVEL_ERROR,
+            "Failed to configure the FIFO, %!HRESULT!", 
+            hr);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        value = (samples > 0) ? 
+            ADXL345_INT_WATERMARK : 
+            ADXL345_INT_ACTIVITY;
+
+        hr = WriteRegister(ADXL345_INT_ENABLE, &value, 1);
+
+        if (FAILED(hr))
+        {
+            Trace(
+                TRACE_LEVEL_ERROR,
+                "Failed to enable %s interrupt, %!HRESULT!", 
+                (samples > 0) ? "watermark" : "activity",
+                hr);
+        }
+        else
+        {
+            m_InterruptsEnabled = value;
+
+            Trace(
+                TRACE_LEVEL_INFORMATION,
+                "FIFO watermark set to %u samples",
+                samples);
+        }
+    }
+
+    //FuncExit();
+
+    return hr;
+}
+
+/////////////////////////////////////////////////////////////////////////
+//
+//  CAccelerometerDevice::DrainFifo
+//
+//  This method is used to read every sample in the FIFO into the data
+//  buffer. All entries are read with one SPB sequence rather than one
+//  request per sample. The caller must hold the device lock.
+//
+//  Parameters:
+//
+//  Return Values:
+//      status
+//
+/////////////////////////////////////////////////////////////////////////
+HRESULT CAccelerometerDevice::DrainFifo()
+{
+    FuncEntry();
+
+    BYTE fifoStatus = 0;
+    ULONG entries = 0;
+
+    HRESULT hr = ReadRegister(
+        ADXL345_FIFO_STATUS,
+        &fifoStatus,
+        sizeof(fifoStatus),
+        0);
+
+    if (SUCCEEDED(hr))
+    {
+        entries = fifoStatus & ADXL345_FIFO_STATUS_ENTRIES_MASK;
+
+        if (entries > ADXL345_FIFO_ENTRIES_MAX)
+        {
+            entries = ADXL345_FIFO_ENTRIES_MAX;
+        }
+    }
+
+    if (SUCCEEDED(hr) && (entries > 0))
+    {
+        // Each read of the data registers pops one entry,
+        // so the same read is repeated for every entry
+        BYTE reg = ADXL345_DATA_X0;
+
+        hr = m_pSpbRequest->CreateAndSendRepeatedWriteReadSequence(
+            &reg,
+            1,
+            m_pDataBuffer,
+            ADXL345_DATA_REPORT_SIZE_BYTES,
+            entries,
+            ADXL345_FIFO_READ_DELAY_US);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        m_BatchedSampleCount = entries;
+
+        Trace(
+            TRACE_LEVEL_VERBOSE,
+            "Drained %lu samples from the FIFO",
+            entries);
+    }
+    else
+    {
+        m_BatchedSampleCount = 0;
+
+        Trace(
+            TRACE_LEVEL_ERROR,
+            "Failed to drain the FIFO, %!HRESULT!",
+            hr);
+    }
+
+    //FuncExit();
+
+    return hr;
+}
+
 /////////////////////////////////////////////////////////////////////////
 //
 //  CAccelerometerDevice::ReadRegister
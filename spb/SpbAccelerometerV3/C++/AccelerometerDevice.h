@@ -93,6 +93,7 @@ protected:
     HRESULT SetDefaultPropertyValues() override;
     HRESULT ConfigureHardware() override;
     HRESULT SetReportInterval(_In_ ULONG ReportInterval) override;
+    HRESULT SetReportLatency(_In_ ULONG ReportLatency) override;
     HRESULT SetChangeSensitivity(_In_ PROPVARIANT* pVar) override;
     HRESULT RequestNewData(_In_ IPortableDeviceValues* pValues) override;
     HRESULT SetDeviceStateStandby() override;
@@ -144,6 +145,10 @@ private:
 
     HRESULT RequestData(_In_ IPortableDeviceValues * pValues);
 
+    BYTE GetFifoSamples();
+    HRESULT EnableEventingInterrupts();
+    HRESULT DrainFifo();
+
     HRESULT ReadRegister(
         _In_                            BYTE   reg,
         _Out_writes_(dataBufferLength)  BYTE*  pDataBuffer,
@@ -169,6 +174,14 @@ private:
     BOOL                                                      m_fInitialized;
     BYTE                                                      m_InterruptsEnabled;
 
+    // Track FIFO batching state. The data buffer holds
+    // m_BatchedSampleCount samples drained from the FIFO
+    // that have not been reported yet.
+    ULONG                                                     m_DataRateInterval;
+    ULONG                                                     m_ReportLatency;
+    BYTE                                                      m_FifoSamples;
+    ULONG                                                     m_BatchedSampleCount;
+
     // Test members		                                      
     ULONG                                                     m_TestRegister;
     ULONG                                                     m_TestDataSize;
@@ -103,6 +103,16 @@ Abstract:
 #define ADXL345_FIFO_CTL_MODE_FIFO          0x40
 #define ADXL345_FIFO_CTL_MODE_STREAM        0x80
 #define ADXL345_FIFO_CTL_MODE_TRIGGER       0xC0
+#define ADXL345_FIFO_CTL_SAMPLES_MASK       0x1F
+
+// FIFO_STATUS register bits
+#define ADXL345_FIFO_STATUS_TRIGGER         0x80
+#define ADXL345_FIFO_STATUS_ENTRIES_MASK    0x3F
+
+// FIFO depth, and the minimum delay needed
+// between reads for the next entry to pop
+#define ADXL345_FIFO_ENTRIES_MAX            32
+#define ADXL345_FIFO_READ_DELAY_US          5
 
 //
 // Bus address
@@ -49,7 +49,8 @@ CClientManager::CClientManager() :
     m_defaultReportInterval(0),
     m_minSupportedReportInterval(0),
     m_minReportInterval(0),
-    m_minReportIntervalExplicitlySet(FALSE)
+    m_minReportIntervalExplicitlySet(FALSE),
+    m_minReportLatency(0)
 {
 
 }
@@ -238,6 +239,7 @@ HRESULT CClientManager::Connect(
                     entry.pDesiredSensitivityValues = spValues.Get();
                     entry.desiredReportInterval = 
                         CURRENT_REPORT_INTERVAL_NOT_SET;
+                    entry.desiredReportLatency = 0;
                 
                     entry.pDesiredSensitivityValues->AddRef();
 
@@ -755,6 +757,44 @@ HRESULT CClientManager::SetDesiredProperty(
             }
         }
 
+        // Report latency
+        else if (IsEqualPropertyKey(
+            key, 
+            SENSOR_PROPERTY_SPB_REPORT_LATENCY) == TRUE)
+        {
+            // Report latency is type unsigned long
+            if (pVar->vt != VT_UI4)
+            {
+                hr = E_INVALIDARG;
+            }
+
+            if (SUCCEEDED(hr))
+            {
+                ULONG reportLatency = pVar->ulVal;
+
+                // Inform the client manager of the client's
+                // desired report latency
+                hr = SetDesiredReportLatency(
+                    pClientFile,
+                    reportLatency);
+
+                if (SUCCEEDED(hr))
+                {
+                    *pVarResult = *pVar;
+                }
+            }
+
+            if (FAILED(hr))
+            {
+                Trace(
+                    TRACE_LEVEL_ERROR,
+                    "Failed to set desired report latency "
+                    "for client %p, %!HRESULT!",
+                    pClientFile,
+                    hr);
+            }
+        }
+
         // Other property key
         else
         {
@@ -865,6 +905,25 @@ HRESULT CClientManager::GetArbitratedProperty(
                     hr);
             }
         }
+        // Report latency
+        else if (IsEqualPropertyKey(key, SENSOR_PROPERTY_SPB_REPORT_LATENCY))
+        {
+            // Synchronize access to minimum property cache
+            auto scopeLock = m_MinPropsCS.Lock();
+
+            hr = InitPropVariantFromUInt32(
+                m_minReportLatency,
+                pVar);
+
+            if (FAILED(hr))
+            {
+                Trace(
+                    TRACE_LEVEL_ERROR,
+                    "Failed to retrieve the report latency value, "
+                    "%!HRESULT!",
+                    hr);
+            }
+        }
         // Other non-settable property
         else
         {
@@ -1161,6 +1220,77 @@ HRESULT CClientManager::SetDesiredReportInterval(
     return hr;
 }
 
+/////////////////////////////////////////////////////////////////////////
+//
+//  CClientManager::SetDesiredReportLatency
+//
+//  This method is used to indicate a client's desired report latency
+//  value.
+//
+//  Parameters:
+//      pClientFile - interface pointer to the application's file handle
+//      reportLatency - client's desired report latency, 0 means the
+//          client does not allow batching
+//
+//  Return Values:
+//      status
+//
+/////////////////////////////////////////////////////////////////////////
+HRESULT CClientManager::SetDesiredReportLatency(
+    _In_ IWDFFile* pClientFile,
+    _In_ ULONG reportLatency
+    )
+{
+    FuncEntry();
+
+    HRESULT hr = S_OK;
+
+    if (pClientFile == nullptr)
+    {
+        hr = E_INVALIDARG;
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        // Synchronize access to the client list and associated members
+        auto scopeLock = m_ClientListCS.Lock();
+
+        // Ensure the client is in the client list
+        CLIENT_MAP::iterator iter = m_pClientList.find(pClientFile);
+        if (iter == m_pClientList.end())
+        {
+            // The client isn't connected
+            hr = HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+
+            Trace(
+                TRACE_LEVEL_ERROR,
+                "Client %p was not found in the client list, %!HRESULT!",
+                pClientFile,
+                hr);
+        }
+        
+        if (SUCCEEDED(hr))
+        {
+            // Save the report latency value
+            iter->second.desiredReportLatency = reportLatency;
+
+            Trace(
+                TRACE_LEVEL_INFORMATION,
+                "Report latency set to %lu for "
+                "client %p",
+                reportLatency,
+                pClientFile);
+
+            // Recalculate new minimum properties
+            hr = RecalculateProperties();
+        }
+    }
+
+    FuncExit();
+
+    return hr;
+}
+
 /////////////////////////////////////////////////////////////////////////
 //
 //  CClientManager::RecalculateProperties
@@ -1201,6 +1331,7 @@ HRESULT CClientManager::RecalculateProperties(
     }
     m_minReportInterval = ULONG_MAX;
     m_minReportIntervalExplicitlySet = FALSE;
+    m_minReportLatency = ULONG_MAX;
 
     // Loop through each client and update the minimum
     // property values as necessary
@@ -1289,6 +1420,14 @@ HRESULT CClientManager::RecalculateProperties(
                     m_minReportInterval = entry.desiredReportInterval;
                     m_minReportIntervalExplicitlySet = TRUE;
                 }
+
+                // Samples can only be batched for as long as
+                // every client allows. A client that has not
+                // set a report latency does not allow batching.
+                if (entry.desiredReportLatency < m_minReportLatency)
+                {
+                    m_minReportLatency = entry.desiredReportLatency;
+                }
             }
         }
 
@@ -1337,10 +1476,20 @@ HRESULT CClientManager::RecalculateProperties(
             m_minReportInterval = m_defaultReportInterval;
         }
 
+        if (m_minReportLatency == ULONG_MAX)
+        {
+            m_minReportLatency = 0;
+        }
+
         Trace(
             TRACE_LEVEL_INFORMATION,
             "Min report interval is %u",
             m_minReportInterval);
+
+        Trace(
+            TRACE_LEVEL_INFORMATION,
+            "Min report latency is %u",
+            m_minReportLatency);
     }
 
     if (FAILED(hr))
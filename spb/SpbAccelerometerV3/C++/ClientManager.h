@@ -27,6 +27,7 @@ typedef struct _CLIENT_ENTRY
     BOOL                    fSubscribed;
     IPortableDeviceValues*  pDesiredSensitivityValues;
     ULONG                   desiredReportInterval;
+    ULONG                   desiredReportLatency;
 } CLIENT_ENTRY, *PCLIENT_ENTRY;
 
 typedef std::map<IWDFFile*, CLIENT_ENTRY> CLIENT_MAP;
@@ -73,6 +74,10 @@ private:
         _In_ IWDFFile* pClientFile,
         _In_ ULONG reportInterval);
 
+    HRESULT SetDesiredReportLatency(
+        _In_ IWDFFile* pClientFile,
+        _In_ ULONG reportLatency);
+
     HRESULT RecalculateProperties();
 
     HRESULT CopyValues(
@@ -94,6 +99,7 @@ private:
     ULONG                                                     m_minSupportedReportInterval;
     ULONG                                                     m_minReportInterval;
     BOOLEAN                                                   m_minReportIntervalExplicitlySet;
+    ULONG                                                     m_minReportLatency;
     Microsoft::WRL::Wrappers::CriticalSection                 m_MinPropsCS;
 };
 
@@ -70,6 +70,19 @@ DEFINE_PROPERTYKEY(SENSOR_PROPERTY_TEST_DATA_SIZE, \
 DEFINE_PROPERTYKEY(SENSOR_PROPERTY_TEST_DATA, \
     0X2F808247, 0X7CDB, 0X4319, 0XBF, 0X5B, 0XE1, 0X6A, 0XB6, 0X7F, 0X73, 0X44, 4); //[VT_VECTOR|VT_UI1]
 
+//
+// Batching properties
+//
+
+// The sensor class extension does not define a report latency
+// property, so it is exposed as a driver-specific settable property.
+// A client sets the maximum time in milliseconds that it allows
+// samples to be held in the hardware FIFO before they are reported.
+// Zero (the default) disables batching.
+//e2f38bb2-fbee-4b3e-92d4-5cd90e946596
+DEFINE_PROPERTYKEY(SENSOR_PROPERTY_SPB_REPORT_LATENCY, \
+    0XE2F38BB2, 0XFBEE, 0X4B3E, 0X92, 0XD4, 0X5C, 0XD9, 0X0E, 0X94, 0X65, 0X96, 2); //[VT_UI4]
+
 enum DATA_UPDATE_MODE {
     DataUpdateModeOff,
     DataUpdateModePolling,
@@ -1540,7 +1540,8 @@ HRESULT CSensorDevice::GetProperty(
     }
     // Settable properties are managed by the client manager
     else if (IsEqualPropertyKey(key, SENSOR_PROPERTY_CHANGE_SENSITIVITY) ||
-        IsEqualPropertyKey(key, SENSOR_PROPERTY_CURRENT_REPORT_INTERVAL))
+        IsEqualPropertyKey(key, SENSOR_PROPERTY_CURRENT_REPORT_INTERVAL) ||
+        IsEqualPropertyKey(key, SENSOR_PROPERTY_SPB_REPORT_LATENCY))
     {
         hr = m_pClientManager->GetArbitratedProperty(key, pVar);
     }
@@ -2214,6 +2215,22 @@ HRESULT CSensorDevice::ApplyUpdatedProperties(
                 m_pReportManager->SetReportInterval(var.ulVal);
             }
         }
+
+        if (SUCCEEDED(hr))
+        {
+            // Update the report latency. This must follow the
+            // report interval since the device sizes its batches
+            // from the resulting data rate.
+            hr = m_pClientManager->GetArbitratedProperty(
+                SENSOR_PROPERTY_SPB_REPORT_LATENCY,
+                &var);
+
+            if (SUCCEEDED(hr))
+            {
+                // Update device with report latency
+                hr = SetReportLatency(var.ulVal);
+            }
+        }
         
         if (SUCCEEDED(hr))
         {
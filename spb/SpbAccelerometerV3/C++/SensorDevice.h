@@ -87,6 +87,7 @@ protected:
     virtual HRESULT SetDefaultPropertyValues() = 0;
     virtual HRESULT ConfigureHardware() = 0;
     virtual HRESULT SetReportInterval(_In_ ULONG ReportInterval) = 0;
+    virtual HRESULT SetReportLatency(_In_ ULONG ReportLatency) = 0;
     virtual HRESULT SetChangeSensitivity(_In_ PROPVARIANT* pVar) = 0;
     virtual HRESULT SetDeviceStateStandby() = 0;
     virtual HRESULT SetDeviceStatePolling() = 0;
@@ -422,6 +422,122 @@ HRESULT CSpbRequest::CreateAndSendWriteReadSequence(
     return hr;
 }
 
+/////////////////////////////////////////////////////////////////////////
+//
+//  CSpbRequest::CreateAndSendRepeatedWriteReadSequence
+//
+//  This method is used to create and send a single SPB sequence request
+//  that repeats the same write-read pair a number of times. It is meant
+//  for draining a device FIFO, where every read pops one entry.
+//
+//  Parameters:
+//      pInBuffer - pointer to the input buffer written before each read
+//      inBufferSize - size of the input buffer
+//      pOutBuffer - pointer to the output buffer, which receives
+//          outBufferSize bytes for each repetition back to back
+//      outBufferSize - size of the output of a single read
+//      repeatCount - number of write-read pairs in the sequence
+//      delayInUs - delay before every repetition after the first
+//
+//  Return Values:
+//      status
+//
+/////////////////////////////////////////////////////////////////////////
+#pragma warning(suppress: 6001 6101) // PREFast cannot understand the use of the IOCTL to write to pOutBuffer
+HRESULT CSpbRequest::CreateAndSendRepeatedWriteReadSequence(
+    _In_reads_(inBufferSize)                 BYTE*   pInBuffer,
+    _In_                                     SIZE_T  inBufferSize,
+    _Out_writes_(outBufferSize * repeatCount) BYTE*   pOutBuffer,
+    _In_                                     SIZE_T  outBufferSize,
+    _In_                                     ULONG   repeatCount,
+    _In_                                     ULONG   delayInUs
+    )
+{
+    FuncEntry();
+
+    auto scopeLock = m_CriticalSection.Lock();
+
+    HRESULT hr = (m_fInitialized == TRUE) ? S_OK : E_UNEXPECTED;
+
+    if (SUCCEEDED(hr))
+    {
+        if ((pInBuffer == nullptr) ||
+            (inBufferSize == 0) ||
+            (pOutBuffer == nullptr) ||
+            (outBufferSize == 0) ||
+            (repeatCount == 0) ||
+            (repeatCount > SPB_REQUEST_MAX_REPEAT_COUNT))
+        {
+            hr = E_INVALIDARG;
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        const ULONG maxTransfers = 2 * SPB_REQUEST_MAX_REPEAT_COUNT;
+
+        SPB_TRANSFER_LIST_AND_ENTRIES(maxTransfers) seq;
+        SPB_TRANSFER_LIST_INIT(&(seq.List), 2 * repeatCount);
+
+        // Build one write-read pair per repetition. The
+        // same register is written each time and each read
+        // lands in the next slot of the output buffer.
+        for (ULONG index = 0; index < repeatCount; index++)
+        {
+            seq.List.Transfers[2 * index] = SPB_TRANSFER_LIST_ENTRY_INIT_SIMPLE(
+                SpbTransferDirectionToDevice,
+                (index == 0) ? 0 : delayInUs,
+                pInBuffer,
+                (ULONG)inBufferSize);
+
+#pragma warning(suppress: 6001 6101 ) // PREFast cannot understand the use of the IOCTL to write to pOutBuffer
+            seq.List.Transfers[2 * index + 1] = SPB_TRANSFER_LIST_ENTRY_INIT_SIMPLE(
+                SpbTransferDirectionFromDevice,
+                0,
+                pOutBuffer + (index * outBufferSize),
+                (ULONG)outBufferSize);
+        }
+
+        ULONG_PTR bytesTransferred;
+
+        // Send only the populated part of the transfer list
+        hr = CreateAndSendIoctl(
+            IOCTL_SPB_EXECUTE_SEQUENCE,
+            (BYTE*)&seq,
+            FIELD_OFFSET(SPB_TRANSFER_LIST, Transfers[2 * repeatCount]),
+            &bytesTransferred);
+
+        if (SUCCEEDED(hr))
+        {
+            SIZE_T expected = repeatCount * (inBufferSize + outBufferSize);
+
+            if (bytesTransferred != expected)
+            {
+                hr = HRESULT_FROM_WIN32(ERROR_BAD_LENGTH);
+                Trace(
+                    TRACE_LEVEL_ERROR,
+                    "Request completed with %lu bytes, expected %lu, "
+                    "%!HRESULT!",
+                    (ULONG)bytesTransferred,
+                    (ULONG)expected,
+                    hr);
+            }
+        }
+
+        if (FAILED(hr))
+        {
+            Trace(
+                TRACE_LEVEL_ERROR,
+                "Failed to send the repeated write-read sequence, %!HRESULT!",
+                hr);
+        }
+    }
+
+    FuncExit();
+
+    return hr;
+}
+
 /////////////////////////////////////////////////////////////////////////
 //
 //  CSpbRequest::CreateAndSendIoctl
@@ -25,6 +25,10 @@ Abstract:
 
 #define SPB_REQUEST_TIMEOUT -1000000 //100ms
 
+// The largest number of write-read pairs that can be
+// sent in a single repeated sequence
+#define SPB_REQUEST_MAX_REPEAT_COUNT 32
+
 class CSpbRequest : public Microsoft::WRL::RuntimeClass<Microsoft::WRL::RuntimeClassFlags<Microsoft::WRL::ClassicCom>, IUnknown>
 {
 public:
@@ -51,6 +55,15 @@ public:
         _In_                         ULONG   delayInUs
         );
 
+    HRESULT CreateAndSendRepeatedWriteReadSequence(
+        _In_reads_(inBufferSize)                 BYTE*   pInBuffer,
+        _In_                                     SIZE_T  inBufferSize,
+        _Out_writes_(outBufferSize * repeatCount) BYTE*   pOutBuffer,
+        _In_                                     SIZE_T  outBufferSize,
+        _In_                                     ULONG   repeatCount,
+        _In_                                     ULONG   delayInUs
+        );
+
     HRESULT Cancel();
 
 // Private methods
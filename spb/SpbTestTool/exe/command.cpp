@@ -46,6 +46,13 @@ PrintCommands()
     printf("  fullduplex {} <numBytes> simultaneously write byte array to peripheral\n");
     printf("                           and read <numBytes> back\n");
     printf("                            > full duplex {01 02 03} 5\n");
+    printf("  benchmark <iterations> <inFlight> <transfers>\n");
+    printf("                           send a sequence <iterations> times keeping\n");
+    printf("                           <inFlight> requests outstanding, and report\n");
+    printf("                           throughput and latency. Each transfer is\n");
+    printf("                           w {} or r <numBytes>, optionally preceded by\n");
+    printf("                           d <us> to delay it\n");
+    printf("                            > benchmark 1000 4 w {32} d 5 r 6\n");
     printf("  signal                   inform the SpbTestTool driver that the\n");
     printf("                           interrupt has been handled\n");
     printf("  help                     print command list\n");
@@ -116,6 +123,10 @@ CCommand::_ParseCommand(
     {
         command = new CFullDuplexCommand(Parameters, tag);
     }
+    else if(_stricmp(name.c_str(), "benchmark") == 0)
+    {
+        command = new CBenchmarkCommand(Parameters, tag);
+    }
     else if(_stricmp(name.c_str(), "signal") == 0)
     {
         command = new CSignalInterruptCommand(Parameters, tag);
@@ -610,6 +621,485 @@ CFullDuplexCommand::Complete(
     }
 }
 
+bool
+CBenchmarkCommand::Parse(
+    void
+    )
+{
+    if (CCommand::Parse() == false)
+    {
+        return false;
+    }
+
+    if (PopNumberParameter(Parameters, 10, &Iterations, bounds(1, MAXULONG)) == false)
+    {
+        printf("Iteration count required\n");
+        return false;
+    }
+
+    if (PopNumberParameter(Parameters, 10, &InFlight, bounds(1, MAXIMUM_WAIT_OBJECTS)) == false)
+    {
+        printf("In-flight count between 1 and %u required\n", MAXIMUM_WAIT_OBJECTS);
+        return false;
+    }
+
+    //
+    // Collect the transfers. Write data is kept aside
+    // until the total length is known.
+    //
+
+    SPBTESTTOOL_SEQUENCE sequence;
+    BUFLIST writes;
+    ULONG delay = 0;
+    bool valid = true;
+
+    ZeroMemory(&sequence, sizeof(sequence));
+
+    while (valid && (Parameters->empty() == false))
+    {
+        string kind;
+
+        PopStringParameter(Parameters, &kind);
+
+        if (_stricmp(kind.c_str(), "d") == 0)
+        {
+            valid = PopNumberParameter(Parameters, 10, &delay);
+            continue;
+        }
+
+        if (sequence.TransferCount == SPBTESTTOOL_MAX_SEQUENCE_TRANSFERS)
+        {
+            printf("At most %u transfers are supported\n",
+                   SPBTESTTOOL_MAX_SEQUENCE_TRANSFERS);
+            valid = false;
+            break;
+        }
+
+        PSPBTESTTOOL_SEQUENCE_TRANSFER transfer = 
+            &sequence.Transfers[sequence.TransferCount];
+
+        if (_stricmp(kind.c_str(), "w") == 0)
+        {
+            pair<ULONG, PBYTE> buf;
+
+            if ((PopBufferParameter(Parameters, &buf) == false) ||
+                (buf.first == 0) ||
+                (buf.first > SPBTESTTOOL_MAX_TRANSFER_LENGTH))
+            {
+                printf("Write transfer requires a buffer of 1 to %u bytes\n",
+                       SPBTESTTOOL_MAX_TRANSFER_LENGTH);
+                valid = false;
+                break;
+            }
+
+            writes.push_back(buf);
+
+            transfer->Direction = SPBTESTTOOL_TRANSFER_WRITE;
+            transfer->Length = buf.first;
+            WriteLength += buf.first;
+        }
+        else if (_stricmp(kind.c_str(), "r") == 0)
+        {
+            ULONG length;
+
+            if (PopNumberParameter(
+                    Parameters, 
+                    10, 
+                    &length, 
+                    bounds(1, SPBTESTTOOL_MAX_TRANSFER_LENGTH)) == false)
+            {
+                printf("Read transfer requires a length of 1 to %u bytes\n",
+                       SPBTESTTOOL_MAX_TRANSFER_LENGTH);
+                valid = false;
+                break;
+            }
+
+            transfer->Direction = SPBTESTTOOL_TRANSFER_READ;
+            transfer->Length = length;
+            ReadLength += length;
+        }
+        else
+        {
+            printf("Unrecognized transfer %s\n", kind.c_str());
+            valid = false;
+            break;
+        }
+
+        transfer->DelayInUs = delay;
+        delay = 0;
+
+        sequence.TransferCount += 1;
+    }
+
+    if (valid && (sequence.TransferCount == 0))
+    {
+        printf("At least one transfer required\n");
+        valid = false;
+    }
+
+    //
+    // Build the IOCTL input buffer: the sequence header
+    // followed by the write data in transfer order.
+    //
+
+    if (valid)
+    {
+        InputLength = sizeof(SPBTESTTOOL_SEQUENCE) + WriteLength;
+        Buffer = new BYTE[InputLength];
+
+        memcpy(Buffer, &sequence, sizeof(sequence));
+
+        PBYTE next = Buffer + sizeof(sequence);
+
+        for (BUFLIST::iterator i = writes.begin(); i != writes.end(); i++)
+        {
+            memcpy(next, i->second, i->first);
+            next += i->first;
+        }
+    }
+
+    for (BUFLIST::iterator i = writes.begin(); i != writes.end(); i++)
+    {
+        delete[] i->second;
+    }
+
+    return valid;
+}
+
+bool
+CBenchmarkCommand::Submit(
+    _In_ SLOT *Slot
+    )
+{
+    QueryPerformanceCounter(&(Slot->Start));
+
+    if ((DeviceIoControl(File, 
+                         IOCTL_SPBTESTTOOL_SEQUENCE,
+                         Buffer,
+                         InputLength,
+                         Slot->ReadBuffer,
+                         ReadLength,
+                         nullptr,
+                         &(Slot->Overlapped)) == FALSE) &&
+        (GetLastError() != ERROR_IO_PENDING))
+    {
+        Record(Slot, GetLastError(), 0);
+        return false;
+    }
+
+    return true;
+}
+
+void
+CBenchmarkCommand::Record(
+    _In_ SLOT  *Slot,
+    _In_ DWORD  Status,
+    _In_ DWORD  Information
+    )
+{
+    if ((Status == NO_ERROR) && (Information != ReadLength))
+    {
+        Status = ERROR_INVALID_DATA;
+    }
+
+    if (Status != NO_ERROR)
+    {
+        if (FirstError == NO_ERROR)
+        {
+            FirstError = Status;
+        }
+
+        Failed += 1;
+        return;
+    }
+
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+
+    ULONGLONG ticks = (ULONGLONG)(now.QuadPart - Slot->Start.QuadPart);
+    ULONGLONG us = (ticks * 1000000) / Frequency;
+    ULONG bucket = 0;
+
+    while ((bucket < (BENCHMARK_HISTOGRAM_BUCKETS - 1)) &&
+           (us >= (2ull << bucket)))
+    {
+        bucket += 1;
+    }
+
+    Histogram[bucket] += 1;
+
+    if ((Succeeded == 0) || (ticks < MinTicks))
+    {
+        MinTicks = ticks;
+    }
+
+    if (ticks > MaxTicks)
+    {
+        MaxTicks = ticks;
+    }
+
+    TotalTicks += ticks;
+    Succeeded += 1;
+}
+
+bool
+CBenchmarkCommand::Execute(
+    VOID
+    )
+{
+    HANDLE events[MAXIMUM_WAIT_OBJECTS];
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    ULONG issued = 0;
+    ULONG outstanding = 0;
+    ULONG s;
+
+    if (File == nullptr)
+    {
+        return false;
+    }
+
+    QueryPerformanceFrequency(&frequency);
+    Frequency = (ULONGLONG)frequency.QuadPart;
+
+    //
+    // Each in-flight request gets its own overlapped
+    // structure, event, and read buffer. The input
+    // buffer is copied by the I/O manager and is shared.
+    //
+
+    Slots = new SLOT[InFlight];
+    ZeroMemory(Slots, sizeof(SLOT) * InFlight);
+
+    for (s = 0; s < InFlight; s++)
+    {
+        Slots[s].Overlapped.hEvent = CreateEvent(nullptr, true, false, nullptr);
+        events[s] = Slots[s].Overlapped.hEvent;
+
+        if (events[s] == nullptr)
+        {
+            printf("error creating I/O event - %u\n", GetLastError());
+            Cancelled = true;
+        }
+
+        if (ReadLength > 0)
+        {
+            Slots[s].ReadBuffer = new BYTE[ReadLength];
+        }
+    }
+
+    QueryPerformanceCounter(&start);
+
+    //
+    // Fill the pipeline, then resubmit from each slot as
+    // it completes so that the driver queue never drains.
+    //
+
+    for (s = 0; (s < InFlight) && (Cancelled == false); s++)
+    {
+        while ((issued < Iterations) && (Cancelled == false))
+        {
+            issued += 1;
+
+            if (Submit(&Slots[s]))
+            {
+                outstanding += 1;
+                break;
+            }
+        }
+    }
+
+    while (outstanding > 0)
+    {
+        DWORD wait = WaitForMultipleObjects(InFlight, events, FALSE, INFINITE);
+
+        if (wait >= (WAIT_OBJECT_0 + InFlight))
+        {
+            printf("WaitForMultipleObjects unexpected return %u - %u\n",
+                   wait,
+                   GetLastError());
+
+            Cancel();
+            break;
+        }
+
+        SLOT* slot = &Slots[wait - WAIT_OBJECT_0];
+        DWORD bytesTransferred = 0;
+        DWORD status = NO_ERROR;
+
+        if (GetOverlappedResult(File, 
+                                &(slot->Overlapped),
+                                &bytesTransferred,
+                                FALSE) == FALSE)
+        {
+            status = GetLastError();
+        }
+
+        ResetEvent(slot->Overlapped.hEvent);
+
+        Record(slot, status, bytesTransferred);
+        outstanding -= 1;
+
+        while ((issued < Iterations) && (Cancelled == false))
+        {
+            issued += 1;
+
+            if (Submit(slot))
+            {
+                outstanding += 1;
+                break;
+            }
+        }
+    }
+
+    QueryPerformanceCounter(&end);
+    ElapsedTicks = (ULONGLONG)(end.QuadPart - start.QuadPart);
+
+    //
+    // Release the slots. Every request has completed
+    // or been abandoned by the wait failure above.
+    //
+
+    SLOT* slots = Slots;
+    Slots = nullptr;
+
+    for (s = 0; s < InFlight; s++)
+    {
+        if (slots[s].Overlapped.hEvent != nullptr)
+        {
+            CloseHandle(slots[s].Overlapped.hEvent);
+        }
+
+        delete[] slots[s].ReadBuffer;
+    }
+
+    delete[] slots;
+
+    FakeCompletion(FirstError, Succeeded);
+
+    return true;
+}
+
+void
+CBenchmarkCommand::Complete(
+    _In_ DWORD        Status,
+    _In_ DWORD        /* Information */
+    )
+{
+    double seconds = (Frequency != 0) ? (double)ElapsedTicks / Frequency : 0;
+    double usPerTick = (Frequency != 0) ? 1000000.0 / Frequency : 0;
+
+    printf("%u transactions completed, %u failed, in %.3f ms\n",
+           Succeeded,
+           Failed,
+           seconds * 1000);
+
+    if (Status != NO_ERROR)
+    {
+        printf("First error %u\n", FirstError);
+    }
+
+    if ((Succeeded == 0) || (seconds == 0))
+    {
+        return;
+    }
+
+    printf("  %u bytes written and %u read per transaction\n",
+           WriteLength,
+           ReadLength);
+    printf("  %.0f transactions/s, %.1f KB/s on the bus\n",
+           Succeeded / seconds,
+           ((double)Succeeded * (WriteLength + ReadLength)) / seconds / 1024);
+    printf("  latency (us): min %.1f, avg %.1f, max %.1f\n",
+           MinTicks * usPerTick,
+           (TotalTicks * usPerTick) / Succeeded,
+           MaxTicks * usPerTick);
+
+    //
+    // Percentiles are reported as the upper bound of the
+    // bucket they fall in.
+    //
+
+    const ULONG percentiles[] = {50, 90, 99};
+    ULONG p = 0;
+    ULONG cumulative = 0;
+    ULONG maxCount = 0;
+    ULONG b;
+
+    printf("  percentiles (us):");
+
+    for (b = 0; (b < BENCHMARK_HISTOGRAM_BUCKETS) && (p < countof(percentiles)); b++)
+    {
+        cumulative += Histogram[b];
+
+        while ((p < countof(percentiles)) &&
+               (((ULONGLONG)cumulative * 100) >= ((ULONGLONG)Succeeded * percentiles[p])))
+        {
+            printf(" p%u < %u", percentiles[p], 2u << b);
+            p += 1;
+        }
+    }
+
+    printf("\n");
+
+    for (b = 0; b < BENCHMARK_HISTOGRAM_BUCKETS; b++)
+    {
+        if (Histogram[b] > maxCount)
+        {
+            maxCount = Histogram[b];
+        }
+    }
+
+    for (b = 0; b < BENCHMARK_HISTOGRAM_BUCKETS; b++)
+    {
+        if (Histogram[b] == 0)
+        {
+            continue;
+        }
+
+        printf("  %8u - %8u us : %8u ",
+               (b == 0) ? 0 : (1u << b),
+               2u << b,
+               Histogram[b]);
+
+        for (ULONG i = 0; i < ((Histogram[b] * 50ull) + maxCount - 1) / maxCount; i++)
+        {
+            printf("#");
+        }
+
+        printf("\n");
+    }
+}
+
+bool
+CBenchmarkCommand::Cancel(
+    VOID
+    )
+{
+    //
+    // Stop resubmitting and cancel whatever is still
+    // outstanding. The slots are only valid while the
+    // benchmark is running.
+    //
+
+    Cancelled = true;
+
+    SLOT* slots = Slots;
+
+    if ((File == nullptr) || (slots == nullptr))
+    {
+        return false;
+    }
+
+    for (ULONG s = 0; s < InFlight; s++)
+    {
+        CancelIoEx(File, &(slots[s].Overlapped));
+    }
+
+    return true;
+}
+
 bool
 CSignalInterruptCommand::Execute(
     VOID
@@ -587,6 +587,108 @@ public:
         );
 };
 
+//
+// Latency histogram buckets. Bucket n counts transactions that
+// took [2^n, 2^(n+1)) microseconds, except that the first bucket
+// also counts anything faster and the last anything slower.
+//
+
+#define BENCHMARK_HISTOGRAM_BUCKETS 24
+
+class CBenchmarkCommand : public CCommand
+{
+private:
+
+    struct SLOT
+    {
+        OVERLAPPED    Overlapped;
+        LARGE_INTEGER Start;
+        PBYTE         ReadBuffer;
+    };
+
+    ULONG  Iterations;
+    ULONG  InFlight;
+    ULONG  InputLength;
+    ULONG  WriteLength;
+    ULONG  ReadLength;
+
+    SLOT*  Slots;
+    volatile bool Cancelled;
+
+    //
+    // Results.
+    //
+
+    ULONG     Succeeded;
+    ULONG     Failed;
+    DWORD     FirstError;
+    ULONGLONG ElapsedTicks;
+    ULONGLONG MinTicks;
+    ULONGLONG MaxTicks;
+    ULONGLONG TotalTicks;
+    ULONGLONG Frequency;
+    ULONG     Histogram[BENCHMARK_HISTOGRAM_BUCKETS];
+
+    bool
+    Submit(
+        _In_ SLOT *Slot
+        );
+
+    void
+    Record(
+        _In_ SLOT  *Slot,
+        _In_ DWORD  Status,
+        _In_ DWORD  Information
+        );
+
+public:
+
+    CBenchmarkCommand(
+        _In_ __drv_aliasesMem list<string> *Parameters,
+        _In_opt_              string        Tag
+        ) : CCommand("benchmark", Parameters),
+            Iterations(0),
+            InFlight(0),
+            InputLength(0),
+            WriteLength(0),
+            ReadLength(0),
+            Slots(nullptr),
+            Cancelled(false),
+            Succeeded(0),
+            Failed(0),
+            FirstError(NO_ERROR),
+            ElapsedTicks(0),
+            MinTicks(0),
+            MaxTicks(0),
+            TotalTicks(0),
+            Frequency(0)
+    {
+        ZeroMemory(Histogram, sizeof(Histogram));
+        return;
+    }
+
+    bool
+    Parse(
+        void
+        );
+
+    bool
+    Execute(
+        VOID
+        );
+
+    void
+    Complete(
+        _In_ DWORD        Status,
+        _In_ DWORD        Information
+        );
+
+    bool
+    Cancel(
+        VOID
+        );
+};
+
 class CSignalInterruptCommand : public CCommand
 {
 private:
@@ -729,6 +729,10 @@ Return Value:
         SpbPeripheralFullDuplex(pDevice, FxRequest);
         break;
 
+    case IOCTL_SPBTESTTOOL_SEQUENCE:
+        SpbPeripheralSequence(pDevice, FxRequest);
+        break;
+
     case IOCTL_SPBTESTTOOL_SIGNAL_INTERRUPT:
         SpbPeripheralSignalInterrupt(pDevice, FxRequest);
         break;
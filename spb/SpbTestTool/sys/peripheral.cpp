@@ -1061,6 +1061,299 @@ Done:
     FuncExit(TRACE_FLAG_SPBAPI);
 }
 
+VOID
+SpbPeripheralSequence(
+    _In_  PDEVICE_CONTEXT  pDevice,
+    _In_  WDFREQUEST       FxRequest
+    )
+/*++
+ 
+  Routine Description:
+
+    This routine sends a client-described sequence of writes and
+    reads to the SPB controller as a single IOCTL_SPB_EXECUTE_SEQUENCE.
+
+  Arguments:
+
+    pDevice - a pointer to the device context
+    FxRequest - the framework request object
+
+  Return Value:
+
+    None
+
+--*/
+{
+    FuncEntry(TRACE_FLAG_SPBAPI);
+
+    PSPBTESTTOOL_SEQUENCE pSequence = nullptr;
+    PUCHAR pWriteData = nullptr;
+    PUCHAR pReadData = nullptr;
+    size_t inputBufferLength = 0;
+    size_t outputBufferLength = 0;
+    ULONG writeLength = 0;
+    ULONG readLength = 0;
+    ULONG i;
+    WDF_OBJECT_ATTRIBUTES attributes;
+    PREQUEST_CONTEXT pRequest;
+    NTSTATUS status;
+
+    pRequest = GetRequestContext(pDevice->SpbRequest);
+
+    Trace(
+        TRACE_LEVEL_INFORMATION,
+        TRACE_FLAG_SPBAPI,
+        "Formatting SPB request %p for IOCTL_SPB_EXECUTE_SEQUENCE",
+        pDevice->SpbRequest);
+        
+    //
+    // Save the client request.
+    //
+
+    pDevice->ClientRequest = FxRequest;
+
+    //
+    // Get and validate the sequence description.
+    //
+
+    status = WdfRequestRetrieveInputBuffer(
+        FxRequest,
+        sizeof(SPBTESTTOOL_SEQUENCE),
+        (PVOID*)&pSequence,
+        &inputBufferLength);
+
+    if (!NT_SUCCESS(status))
+    {
+        Trace(
+            TRACE_LEVEL_ERROR,
+            TRACE_FLAG_SPBAPI,
+            "Failed to retrieve input buffer - %!STATUS!",
+            status);
+
+        goto Done;
+    }
+
+    if ((pSequence->TransferCount == 0) ||
+        (pSequence->TransferCount > SPBTESTTOOL_MAX_SEQUENCE_TRANSFERS))
+    {
+        status = STATUS_INVALID_PARAMETER;
+        Trace(
+            TRACE_LEVEL_ERROR,
+            TRACE_FLAG_SPBAPI,
+            "Invalid sequence transfer count %lu - %!STATUS!",
+            pSequence->TransferCount,
+            status);
+
+        goto Done;
+    }
+
+    for (i = 0; i < pSequence->TransferCount; i++)
+    {
+        PSPBTESTTOOL_SEQUENCE_TRANSFER pTransfer = &pSequence->Transfers[i];
+
+        //
+        // Bounding each length keeps the totals from overflowing.
+        //
+
+        if ((pTransfer->Length == 0) ||
+            (pTransfer->Length > SPBTESTTOOL_MAX_TRANSFER_LENGTH))
+        {
+            status = STATUS_INVALID_PARAMETER;
+        }
+        else if (pTransfer->Direction == SPBTESTTOOL_TRANSFER_WRITE)
+        {
+            writeLength += pTransfer->Length;
+        }
+        else if (pTransfer->Direction == SPBTESTTOOL_TRANSFER_READ)
+        {
+            readLength += pTransfer->Length;
+        }
+        else
+        {
+            status = STATUS_INVALID_PARAMETER;
+        }
+
+        if (!NT_SUCCESS(status))
+        {
+            Trace(
+                TRACE_LEVEL_ERROR,
+                TRACE_FLAG_SPBAPI,
+                "Invalid sequence transfer %lu - %!STATUS!",
+                i,
+                status);
+
+            goto Done;
+        }
+    }
+
+    if (inputBufferLength != (sizeof(SPBTESTTOOL_SEQUENCE) + writeLength))
+    {
+        status = STATUS_INVALID_BUFFER_SIZE;
+        Trace(
+            TRACE_LEVEL_ERROR,
+            TRACE_FLAG_SPBAPI,
+            "Sequence input length %lu does not match write length %lu - %!STATUS!",
+            (ULONG)inputBufferLength,
+            writeLength,
+            status);
+
+        goto Done;
+    }
+
+    pWriteData = (PUCHAR)(pSequence + 1);
+
+    if (readLength > 0)
+    {
+        status = WdfRequestRetrieveOutputBuffer(
+            FxRequest,
+            readLength,
+            (PVOID*)&pReadData,
+            &outputBufferLength);
+
+        if (!NT_SUCCESS(status))
+        {
+            Trace(
+                TRACE_LEVEL_ERROR,
+                TRACE_FLAG_SPBAPI,
+                "Failed to retrieve output buffer - %!STATUS!",
+                status);
+
+            goto Done;
+        }
+    }
+
+    //
+    // Build SPB sequence. Each transfer consumes the next
+    // slice of the write data or the output buffer.
+    //
+
+    SPB_TRANSFER_LIST_AND_ENTRIES(SPBTESTTOOL_MAX_SEQUENCE_TRANSFERS) seq;
+    SPB_TRANSFER_LIST_INIT(&(seq.List), pSequence->TransferCount);
+
+    for (i = 0; i < pSequence->TransferCount; i++)
+    {
+        PSPBTESTTOOL_SEQUENCE_TRANSFER pTransfer = &pSequence->Transfers[i];
+
+        if (pTransfer->Direction == SPBTESTTOOL_TRANSFER_WRITE)
+        {
+            seq.List.Transfers[i] = SPB_TRANSFER_LIST_ENTRY_INIT_SIMPLE(
+                SpbTransferDirectionToDevice,
+                pTransfer->DelayInUs,
+                pWriteData,
+                pTransfer->Length);
+
+            pWriteData += pTransfer->Length;
+        }
+        else
+        {
+            seq.List.Transfers[i] = SPB_TRANSFER_LIST_ENTRY_INIT_SIMPLE(
+                SpbTransferDirectionFromDevice,
+                pTransfer->DelayInUs,
+                pReadData,
+                pTransfer->Length);
+
+            pReadData += pTransfer->Length;
+        }
+    }
+
+    //
+    // Create preallocated WDFMEMORY covering only the
+    // populated transfer entries.
+    //
+
+    NT_ASSERT(pDevice->InputMemory == WDF_NO_HANDLE);
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+
+    status = WdfMemoryCreatePreallocated(
+        &attributes,
+        (PVOID)&seq,
+        FIELD_OFFSET(SPB_TRANSFER_LIST, Transfers[pSequence->TransferCount]),
+        &pDevice->InputMemory);
+
+    if (!NT_SUCCESS(status))
+    {
+        Trace(
+            TRACE_LEVEL_ERROR,
+            TRACE_FLAG_SPBAPI,
+            "Failed to create WDFMEMORY - %!STATUS!",
+            status);
+
+        goto Done;
+    }
+
+    Trace(
+        TRACE_LEVEL_INFORMATION,
+        TRACE_FLAG_SPBAPI,
+        "Built sequence %p with %lu transfers and byte length=%lu",
+        &seq,
+        pSequence->TransferCount,
+        writeLength + readLength);
+
+    //
+    // Mark SPB request as sequence and save the write
+    // length so the client request is completed with
+    // the number of bytes read.
+    //
+
+    pRequest->IsSpbSequenceRequest = TRUE;
+    pRequest->SequenceWriteLength = (ULONG_PTR)writeLength;
+
+    //
+    // Format and send the SPB sequence request.
+    //
+
+    status = WdfIoTargetFormatRequestForIoctl(
+        pDevice->SpbController,
+        pDevice->SpbRequest,
+        IOCTL_SPB_EXECUTE_SEQUENCE,
+        pDevice->InputMemory,
+        nullptr,
+        nullptr,
+        nullptr);
+
+    if (!NT_SUCCESS(status))
+    {
+        Trace(
+            TRACE_LEVEL_ERROR,
+            TRACE_FLAG_SPBAPI,
+            "Failed to format request - %!STATUS!",
+            status);
+
+        goto Done;
+    }
+
+    status = SpbPeripheralSendRequest(
+        pDevice,
+        pDevice->SpbRequest,
+        FxRequest);
+
+    if (!NT_SUCCESS(status))
+    {
+        Trace(
+            TRACE_LEVEL_ERROR,
+            TRACE_FLAG_SPBAPI,
+            "Failed to send SPB request %p for "
+            "IOCTL_SPB_EXECUTE_SEQUENCE - %!STATUS!",
+            pDevice->SpbRequest,
+            status);
+
+        goto Done;
+    }
+
+Done:
+
+    if (!NT_SUCCESS(status))
+    {
+        SpbPeripheralCompleteRequestPair(
+            pDevice,
+            status,
+            0);
+    }
+
+    FuncExit(TRACE_FLAG_SPBAPI);
+}
+
 VOID
 SpbPeripheralSignalInterrupt(
     _In_  PDEVICE_CONTEXT  pDevice,
@@ -75,6 +75,11 @@ SpbPeripheralFullDuplex(
     _In_   PDEVICE_CONTEXT  pDevice,
     _In_   WDFREQUEST       FxRequest);
 
+VOID
+SpbPeripheralSequence(
+    _In_   PDEVICE_CONTEXT  pDevice,
+    _In_   WDFREQUEST       FxRequest);
+
 VOID
 SpbPeripheralSignalInterrupt(
     _In_  PDEVICE_CONTEXT  pDevice,
@@ -46,5 +46,33 @@ Revision History:
 #define IOCTL_SPBTESTTOOL_SIGNAL_INTERRUPT  CTL_CODE(FILE_DEVICE_SPB_PERIPHERAL, 0x707, METHOD_BUFFERED, FILE_ANY_ACCESS)
 #define IOCTL_SPBTESTTOOL_WAIT_ON_INTERRUPT CTL_CODE(FILE_DEVICE_SPB_PERIPHERAL, 0x708, METHOD_BUFFERED, FILE_ANY_ACCESS)
 #define IOCTL_SPBTESTTOOL_FULL_DUPLEX       CTL_CODE(FILE_DEVICE_SPB_PERIPHERAL, 0x709, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_SPBTESTTOOL_SEQUENCE          CTL_CODE(FILE_DEVICE_SPB_PERIPHERAL, 0x70A, METHOD_OUT_DIRECT, FILE_ANY_ACCESS)
+
+//
+// IOCTL_SPBTESTTOOL_SEQUENCE input buffer. The header is
+// followed by the data for every write transfer, back to
+// back and in order. The output buffer receives the data
+// for every read transfer the same way. The output buffer
+// is direct so that read data never overlaps write data.
+//
+
+#define SPBTESTTOOL_MAX_SEQUENCE_TRANSFERS  16
+#define SPBTESTTOOL_MAX_TRANSFER_LENGTH     0x10000
+
+#define SPBTESTTOOL_TRANSFER_WRITE          0
+#define SPBTESTTOOL_TRANSFER_READ           1
+
+typedef struct _SPBTESTTOOL_SEQUENCE_TRANSFER
+{
+    ULONG Direction;
+    ULONG Length;
+    ULONG DelayInUs;
+} SPBTESTTOOL_SEQUENCE_TRANSFER, *PSPBTESTTOOL_SEQUENCE_TRANSFER;
+
+typedef struct _SPBTESTTOOL_SEQUENCE
+{
+    ULONG TransferCount;
+    SPBTESTTOOL_SEQUENCE_TRANSFER Transfers[SPBTESTTOOL_MAX_SEQUENCE_TRANSFERS];
+} SPBTESTTOOL_SEQUENCE, *PSPBTESTTOOL_SEQUENCE;
 
 #endif _SPBTESTIOCTL_H_
\ No newline at end of file
@@ -276,6 +276,63 @@ typedef struct _CDROM_SCRATCH_READ_WRITE_CONTEXT {
 
 } CDROM_SCRATCH_READ_WRITE_CONTEXT, *PCDROM_SCRATCH_READ_WRITE_CONTEXT;
 
+// Number of READ commands kept outstanding by the read pipeline for
+// reads that must be split into more than one transfer.
+#define CDROM_READ_PIPELINE_DEPTH   3
+
+typedef struct _CDROM_READ_PIPELINE *PCDROM_READ_PIPELINE;
+
+// One READ command of the read pipeline.
+typedef struct _CDROM_READ_PIPELINE_SLOT {
+
+    PCDROM_READ_PIPELINE    Pipeline;
+
+    WDFREQUEST              Request;
+    SCSI_REQUEST_BLOCK      Srb;
+    SENSE_DATA              Sense;
+
+    PMDL                    PartialMdl;
+    BOOLEAN                 PartialMdlIsBuilt;
+
+    // The part of the original request this slot transfers
+    ULONG                   Offset;
+    ULONG                   Length;
+
+    // Stuff for asynchronous retrying of the transfer.
+    ULONG                   NumRetries;
+    KTIMER                  RetryTimer;
+    KDPC                    RetryDpc;
+
+} CDROM_READ_PIPELINE_SLOT, *PCDROM_READ_PIPELINE_SLOT;
+
+// Keeps several max-transfer-length READ commands of a large read
+// outstanding at once, instead of sending them one after another.
+typedef struct _CDROM_READ_PIPELINE {
+
+    // FALSE if the slots could not be allocated; reads then use the scratch SRB.
+    BOOLEAN                     Allocated;
+
+    PCDROM_DEVICE_EXTENSION     DeviceExtension;
+
+    KSPIN_LOCK                  Lock;
+
+    // The read currently handled by the pipeline
+    WDFREQUEST                  OriginalRequest;
+
+    // Bytes of the read handed to slots so far
+    ULONG                       IssuedBytes;
+
+    // Slots in flight, plus one while the pipeline is being started
+    ULONG                       OutstandingCount;
+
+    // Offset of the lowest failed transfer, EntireXferLen if none failed
+    ULONG                       FailedOffset;
+    NTSTATUS                    FailedStatus;
+
+    CDROM_READ_PIPELINE_SLOT    Slots[CDROM_READ_PIPELINE_DEPTH];
+
+} CDROM_READ_PIPELINE;
+
 // Many commands get double-buffered.  Since the max
 // transfer size is typically 64k, most of these requests
 // can be handled with a single pre-allocated buffer.
@@ -305,6 +362,9 @@ typedef struct _CDROM_SCRATCH_CONTEXT {
 
     // Read Write context
     CDROM_SCRATCH_READ_WRITE_CONTEXT ScratchReadWriteContext;
+
+    // Pipelined read engine for large reads
+    CDROM_READ_PIPELINE              ReadPipeline;
   
 } CDROM_SCRATCH_CONTEXT, *PCDROM_SCRATCH_CONTEXT;
 
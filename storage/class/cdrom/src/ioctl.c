@@ -6476,7 +6476,17 @@ Return Value:
         originalRequestContext->ReadWriteRetryInitialized = FALSE;
         originalRequestContext->DeviceExtension = DeviceExtension;
 
-        status = ScratchBuffer_PerformNextReadWrite(DeviceExtension, TRUE);
+        if (readWriteContext->IsRead &&
+            (packetsCount > 1) &&
+            DeviceExtension->ScratchContext.ReadPipeline.Allocated)
+        {
+            // keep several transfers of a large read outstanding at once
+            status = ScratchBuffer_PerformPipelinedRead(DeviceExtension);
+        }
+        else
+        {
+            status = ScratchBuffer_PerformNextReadWrite(DeviceExtension, TRUE);
+        }
                         
         // We do not call ScratchBuffer_EndUse here, because we're not releasing the scratch SRB.
         // It will be released in the completion routine.
@@ -37,11 +37,15 @@ Revision History:
 
 // Forward declarations
 EVT_WDF_REQUEST_COMPLETION_ROUTINE  ScratchBuffer_ReadWriteCompletionRoutine;
+EVT_WDF_REQUEST_COMPLETION_ROUTINE  ScratchBuffer_ReadPipelineCompletionRoutine;
+KDEFERRED_ROUTINE                   ScratchBuffer_ReadPipelineRetryTimerRoutine;
 
 #ifdef ALLOC_PRAGMA
 
 #pragma alloc_text(PAGE, ScratchBuffer_Deallocate)
 #pragma alloc_text(PAGE, ScratchBuffer_Allocate)
+#pragma alloc_text(PAGE, ScratchBuffer_AllocateReadPipeline)
+#pragma alloc_text(PAGE, ScratchBuffer_DeallocateReadPipeline)
 #pragma alloc_text(PAGE, ScratchBuffer_SetupSrb)
 #pragma alloc_text(PAGE, ScratchBuffer_ExecuteCdbEx)
 
@@ -72,6 +76,8 @@ Return Value:
 
     NT_ASSERT(DeviceExtension->ScratchContext.ScratchInUse == 0);
 
+    ScratchBuffer_DeallocateReadPipeline(DeviceExtension);
+
     if (DeviceExtension->ScratchContext.ScratchHistory != NULL)
     {
         ExFreePool(DeviceExtension->ScratchContext.ScratchHistory);
@@ -334,6 +340,11 @@ Return Value:
     {
         ScratchBuffer_Deallocate(DeviceExtension);
     }
+    else
+    {
+        // the read pipeline is optional, a failure here is not fatal
+        ScratchBuffer_AllocateReadPipeline(DeviceExtension);
+    }
 
     return NT_SUCCESS(status);
 }
@@ -1206,26 +1217,33 @@ ValidateSrbHistoryDataPresumptions(
 }
 
 VOID
-ScratchBuffer_SetupReadWriteSrb(
-    _Inout_ PCDROM_DEVICE_EXTENSION     DeviceExtension,
+ScratchBuffer_BuildReadWriteSrb(
+    _In_    PCDROM_DEVICE_EXTENSION     DeviceExtension,
     _In_    WDFREQUEST                  OriginalRequest,
+    _In_    PIRP                        Irp,
+    _Out_   PSCSI_REQUEST_BLOCK         Srb,
+    _In_    PSENSE_DATA                 SenseBuffer,
     _In_    LARGE_INTEGER               StartingOffset,
     _In_    ULONG                       RequiredLength,
-    _Inout_updates_bytes_(RequiredLength) UCHAR* DataBuffer,
-    _In_    BOOLEAN                     IsReadRequest,
-    _In_    BOOLEAN                     UsePartialMdl
+    _In_    UCHAR*                      DataBuffer,
+    _In_    BOOLEAN                     IsReadRequest
     )
 /*++
 
 Routine Description:
 
-    setup SRB for read/write request.
+    build the SRB and CDB of a read/write transfer, and point the next
+    stack location of the irp that carries it at the SRB.
 
 Arguments:
 
     DeviceExtension - device extension
     OriginalRequest - read/write request
+    Irp - the irp that will carry the SRB
+    Srb - the SRB to build
+    SenseBuffer - sense buffer for the SRB
     StartingOffset - read/write starting offset
+    RequiredLength - number of bytes to transfer
     DataBuffer - buffer for read/write
     IsReadRequest - TRUE (read); FALSE (write)
 
@@ -1235,28 +1253,18 @@ Return Value:
 
 --*/
 {
-    //NOTE: R/W request not use the ScratchBuffer, instead, it uses the buffer associated with IRP.
-
-    PSCSI_REQUEST_BLOCK srb = DeviceExtension->ScratchContext.ScratchSrb;
-    PCDB                cdb = (PCDB)srb->Cdb;
+    PCDB                cdb = (PCDB)Srb->Cdb;
     LARGE_INTEGER       logicalBlockAddr;
     ULONG               numTransferBlocks;
 
     PIRP                originalIrp = WdfRequestWdmGetIrp(OriginalRequest);
 
-    PIRP                irp = WdfRequestWdmGetIrp(DeviceExtension->ScratchContext.ScratchRequest);
     PIO_STACK_LOCATION  irpStack = NULL;
 
-    PCDROM_REQUEST_CONTEXT  requestContext = RequestGetContext(DeviceExtension->ScratchContext.ScratchRequest);
-
-    requestContext->OriginalRequest = OriginalRequest;
-
-
     logicalBlockAddr.QuadPart = Int64ShrlMod32(StartingOffset.QuadPart, DeviceExtension->SectorShift);
     numTransferBlocks = RequiredLength >> DeviceExtension->SectorShift;
 
-    // set to use the full scratch buffer via the scratch SRB
-    irpStack = IoGetNextIrpStackLocation(irp);
+    irpStack = IoGetNextIrpStackLocation(Irp);
     irpStack->MajorFunction = IRP_MJ_SCSI;
     if (IsReadRequest)
     {
@@ -1266,22 +1274,22 @@ Return Value:
     {
         irpStack->Parameters.DeviceIoControl.IoControlCode = IOCTL_SCSI_EXECUTE_OUT;
     }
-    irpStack->Parameters.Scsi.Srb = srb;
+    irpStack->Parameters.Scsi.Srb = Srb;
 
     // prepare the SRB with default values
-    srb->Length = SCSI_REQUEST_BLOCK_SIZE;
-    srb->Function = SRB_FUNCTION_EXECUTE_SCSI;
-    srb->QueueAction = SRB_SIMPLE_TAG_REQUEST;
-    srb->SrbStatus = 0;
-    srb->ScsiStatus = 0;
-    srb->NextSrb = NULL;
-    srb->SenseInfoBufferLength = SENSE_BUFFER_SIZE;
-    srb->SenseInfoBuffer = DeviceExtension->ScratchContext.ScratchSense;
-
-    srb->DataBuffer = DataBuffer;
-    srb->DataTransferLength = RequiredLength;
-
-    srb->QueueSortKey = logicalBlockAddr.LowPart;
+    Srb->Length = SCSI_REQUEST_BLOCK_SIZE;
+    Srb->Function = SRB_FUNCTION_EXECUTE_SCSI;
+    Srb->QueueAction = SRB_SIMPLE_TAG_REQUEST;
+    Srb->SrbStatus = 0;
+    Srb->ScsiStatus = 0;
+    Srb->NextSrb = NULL;
+    Srb->SenseInfoBufferLength = SENSE_BUFFER_SIZE;
+    Srb->SenseInfoBuffer = SenseBuffer;
+
+    Srb->DataBuffer = DataBuffer;
+    Srb->DataTransferLength = RequiredLength;
+
+    Srb->QueueSortKey = logicalBlockAddr.LowPart;
     if (logicalBlockAddr.QuadPart > 0xFFFFFFFF) 
     {
         //
@@ -1289,11 +1297,11 @@ Return Value:
         // QueueSortKey to the maximum value, so that these
         // requests can be added towards the end of the queue.
         //
-        srb->QueueSortKey = 0xFFFFFFFF;
+        Srb->QueueSortKey = 0xFFFFFFFF;
     }
 
-    srb->OriginalRequest = irp;
-    srb->TimeOutValue = DeviceExtension->TimeOutValue;
+    Srb->OriginalRequest = Irp;
+    Srb->TimeOutValue = DeviceExtension->TimeOutValue;
 
     if (RequestIsRealtimeStreaming(OriginalRequest, IsReadRequest) &&
         !TEST_FLAG(DeviceExtension->PrivateFdoData->HackFlags, FDO_HACK_NO_STREAMING))
@@ -1305,7 +1313,7 @@ Return Value:
             REVERSE_BYTES(&cdb->READ12.TransferLength, &numTransferBlocks);
             cdb->READ12.Streaming = 1;
             cdb->READ12.OperationCode = SCSIOP_READ12;
-            srb->CdbLength = sizeof(cdb->READ12);
+            Srb->CdbLength = sizeof(cdb->READ12);
         }
         else
         {
@@ -1314,7 +1322,7 @@ Return Value:
             REVERSE_BYTES(&cdb->WRITE12.TransferLength, &numTransferBlocks);
             cdb->WRITE12.Streaming = 1;
             cdb->WRITE12.OperationCode = SCSIOP_WRITE12;
-            srb->CdbLength = sizeof(cdb->WRITE12);
+            Srb->CdbLength = sizeof(cdb->WRITE12);
         }
     }
     else
@@ -1327,19 +1335,83 @@ Return Value:
         cdb->CDB10.TransferBlocksMsb = ((PFOUR_BYTE)&numTransferBlocks)->Byte1;
         cdb->CDB10.TransferBlocksLsb = ((PFOUR_BYTE)&numTransferBlocks)->Byte0;
         cdb->CDB10.OperationCode = (IsReadRequest) ? SCSIOP_READ : SCSIOP_WRITE;
-        srb->CdbLength = sizeof(cdb->CDB10);
+        Srb->CdbLength = sizeof(cdb->CDB10);
     }
 
     //  Set SRB and IRP flags
-    srb->SrbFlags = DeviceExtension->SrbFlags;
+    Srb->SrbFlags = DeviceExtension->SrbFlags;
     if (TEST_FLAG(originalIrp->Flags, IRP_PAGING_IO) ||
         TEST_FLAG(originalIrp->Flags, IRP_SYNCHRONOUS_PAGING_IO))
     {
-        SET_FLAG(srb->SrbFlags, SRB_CLASS_FLAGS_PAGING);
+        SET_FLAG(Srb->SrbFlags, SRB_CLASS_FLAGS_PAGING);
     }
 
-    SET_FLAG(srb->SrbFlags, (IsReadRequest) ? SRB_FLAGS_DATA_IN : SRB_FLAGS_DATA_OUT);
-    SET_FLAG(srb->SrbFlags, SRB_FLAGS_ADAPTER_CACHE_ENABLE);
+    SET_FLAG(Srb->SrbFlags, (IsReadRequest) ? SRB_FLAGS_DATA_IN : SRB_FLAGS_DATA_OUT);
+    SET_FLAG(Srb->SrbFlags, SRB_FLAGS_ADAPTER_CACHE_ENABLE);
+
+    //DBGLOGSENDPACKET(Pkt);
+    //HISTORYLOGSENDPACKET(Pkt);
+
+    //
+    // Set the original irp here for SFIO.
+    //
+    Srb->SrbExtension = (PVOID)(originalIrp);
+
+    return;
+}
+
+VOID
+ScratchBuffer_SetupReadWriteSrb(
+    _Inout_ PCDROM_DEVICE_EXTENSION     DeviceExtension,
+    _In_    WDFREQUEST                  OriginalRequest,
+    _In_    LARGE_INTEGER               StartingOffset,
+    _In_    ULONG                       RequiredLength,
+    _Inout_updates_bytes_(RequiredLength) UCHAR* DataBuffer,
+    _In_    BOOLEAN                     IsReadRequest,
+    _In_    BOOLEAN                     UsePartialMdl
+    )
+/*++
+
+Routine Description:
+
+    setup SRB for read/write request.
+
+Arguments:
+
+    DeviceExtension - device extension
+    OriginalRequest - read/write request
+    StartingOffset - read/write starting offset
+    DataBuffer - buffer for read/write
+    IsReadRequest - TRUE (read); FALSE (write)
+
+Return Value:
+
+    none
+
+--*/
+{
+    //NOTE: R/W request not use the ScratchBuffer, instead, it uses the buffer associated with IRP.
+
+    PSCSI_REQUEST_BLOCK srb = DeviceExtension->ScratchContext.ScratchSrb;
+
+    PIRP                originalIrp = WdfRequestWdmGetIrp(OriginalRequest);
+
+    PIRP                irp = WdfRequestWdmGetIrp(DeviceExtension->ScratchContext.ScratchRequest);
+
+    PCDROM_REQUEST_CONTEXT  requestContext = RequestGetContext(DeviceExtension->ScratchContext.ScratchRequest);
+
+    requestContext->OriginalRequest = OriginalRequest;
+
+    // set to use the full scratch buffer via the scratch SRB
+    ScratchBuffer_BuildReadWriteSrb(DeviceExtension,
+                                    OriginalRequest,
+                                    irp,
+                                    srb,
+                                    DeviceExtension->ScratchContext.ScratchSense,
+                                    StartingOffset,
+                                    RequiredLength,
+                                    DataBuffer,
+                                    IsReadRequest);
 
     //
     // If the request is not split, we can use the original IRP MDL.  If the
@@ -1363,14 +1435,6 @@ Return Value:
         irp->MdlAddress = DeviceExtension->ScratchContext.PartialMdl;
     }
 
-    //DBGLOGSENDPACKET(Pkt);
-    //HISTORYLOGSENDPACKET(Pkt);
-
-    //
-    // Set the original irp here for SFIO.
-    //
-    srb->SrbExtension = (PVOID)(originalIrp);
-
     return;
 }
 
@@ -1461,4 +1525,630 @@ Return Value:
     return status;
 }
 
+_IRQL_requires_max_(APC_LEVEL)
+VOID
+ScratchBuffer_DeallocateReadPipeline(
+    _Inout_ PCDROM_DEVICE_EXTENSION DeviceExtension
+    )
+/*++
+
+Routine Description:
+
+    release all resources allocated for the read pipeline.
+
+Arguments:
+
+    DeviceExtension - device extension
+
+Return Value:
+
+    none
+
+--*/
+{
+    PCDROM_READ_PIPELINE    pipeline = &DeviceExtension->ScratchContext.ReadPipeline;
+    ULONG                   i;
+
+    PAGED_CODE ();
+
+    NT_ASSERT(pipeline->OriginalRequest == NULL);
+
+    pipeline->Allocated = FALSE;
+
+    for (i = 0; i < CDROM_READ_PIPELINE_DEPTH; i++)
+    {
+        PCDROM_READ_PIPELINE_SLOT slot = &pipeline->Slots[i];
+
+        if (slot->PartialMdl != NULL)
+        {
+            IoFreeMdl(slot->PartialMdl);
+            slot->PartialMdl = NULL;
+        }
+
+        if (slot->Request != NULL)
+        {
+            PIRP irp = WdfRequestWdmGetIrp(slot->Request);
+            if (irp->MdlAddress)
+            {
+                irp->MdlAddress = NULL;
+            }
+            WdfObjectDelete(slot->Request);
+            slot->Request = NULL;
+        }
+    }
+
+    return;
+}
+
+_IRQL_requires_max_(APC_LEVEL)
+VOID
+ScratchBuffer_AllocateReadPipeline(
+    _Inout_ PCDROM_DEVICE_EXTENSION DeviceExtension
+    )
+/*++
+
+Routine Description:
+
+    allocate the requests and MDLs of the read pipeline. The pipeline is
+    optional: if this fails, large reads are sent one transfer at a time
+    through the scratch SRB.
+
+Arguments:
+
+    DeviceExtension - device extension
+
+Return Value:
+
+    none
+
+--*/
+{
+    NTSTATUS                status = STATUS_SUCCESS;
+    PCDROM_READ_PIPELINE    pipeline = &DeviceExtension->ScratchContext.ReadPipeline;
+    ULONG                   transferLength = 0;
+    ULONG                   i;
+
+    PAGED_CODE ();
+
+    if (pipeline->Allocated)
+    {
+        return;
+    }
+
+    KeInitializeSpinLock(&pipeline->Lock);
+    pipeline->DeviceExtension = DeviceExtension;
+    pipeline->OriginalRequest = NULL;
+
+    status = RtlULongAdd(DeviceExtension->DeviceAdditionalData.MaxPageAlignedTransferBytes, PAGE_SIZE, &transferLength);
+
+    for (i = 0; (i < CDROM_READ_PIPELINE_DEPTH) && NT_SUCCESS(status); i++)
+    {
+        PCDROM_READ_PIPELINE_SLOT   slot = &pipeline->Slots[i];
+        WDF_OBJECT_ATTRIBUTES       attributes;
+
+        slot->Pipeline = pipeline;
+        slot->PartialMdlIsBuilt = FALSE;
+
+        KeInitializeTimer(&slot->RetryTimer);
+        KeInitializeDpc(&slot->RetryDpc, ScratchBuffer_ReadPipelineRetryTimerRoutine, slot);
+
+        WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, 
+                                                CDROM_REQUEST_CONTEXT);
+
+        status = WdfRequestCreate(&attributes,
+                                  DeviceExtension->IoTarget,
+                                  &slot->Request);
+
+        if (NT_SUCCESS(status))
+        {
+            slot->PartialMdl = IoAllocateMdl(NULL,
+                                             transferLength,
+                                             FALSE,
+                                             FALSE,
+                                             NULL);
+            if (slot->PartialMdl == NULL)
+            {
+                status = STATUS_INSUFFICIENT_RESOURCES;
+            }
+        }
+    }
+
+    if (NT_SUCCESS(status))
+    {
+        pipeline->Allocated = TRUE;
+    }
+    else
+    {
+        TracePrint((TRACE_LEVEL_WARNING, TRACE_FLAG_INIT,
+                    "Failed to allocate read pipeline, %!STATUS!\n",
+                    status
+                    ));
+
+        ScratchBuffer_DeallocateReadPipeline(DeviceExtension);
+    }
+
+    return;
+}
+
+
+NTSTATUS
+ScratchBuffer_ReadPipelineSendSlot(
+    _Inout_ PCDROM_READ_PIPELINE_SLOT   Slot,
+    _In_ BOOLEAN                        FirstTry
+    )
+/*++
+
+Routine Description:
+
+    This function asynchronously sends the READ command of a pipeline slot
+    down the stack.
+
+Arguments:
+
+    Slot - the pipeline slot, with its Offset and Length set
+    FirstTry - FALSE if this is a retry of the slot's transfer
+
+Return Value:
+
+    NTSTATUS - on failure the slot's completion routine will not be called
+
+--*/
+{
+    PCDROM_READ_PIPELINE                pipeline = Slot->Pipeline;
+    PCDROM_DEVICE_EXTENSION             deviceExtension = pipeline->DeviceExtension;
+    PCDROM_SCRATCH_READ_WRITE_CONTEXT   readWriteContext = &deviceExtension->ScratchContext.ScratchReadWriteContext;
+    PCDROM_REQUEST_CONTEXT              requestContext = RequestGetContext(Slot->Request);
+    PIRP                                originalIrp = WdfRequestWdmGetIrp(pipeline->OriginalRequest);
+    PIRP                                irp = WdfRequestWdmGetIrp(Slot->Request);
+    WDF_REQUEST_REUSE_PARAMS            reuseParams;
+    LARGE_INTEGER                       startingOffset;
+    PUCHAR                              dataBuffer;
+    NTSTATUS                            status = STATUS_SUCCESS;
+
+    if (FirstTry)
+    {
+        Slot->NumRetries = 0;
+    }
+
+    if (WdfRequestIsCanceled(pipeline->OriginalRequest))
+    {
+        return STATUS_CANCELLED;
+    }
+
+    // re-use the KMDF request object, see ScratchBuffer_ResetItems
+    irp->MdlAddress = NULL;
+
+    WDF_REQUEST_REUSE_PARAMS_INIT(&reuseParams, WDF_REQUEST_REUSE_NO_FLAGS, STATUS_NOT_SUPPORTED);
+    status = WdfRequestReuse(Slot->Request, &reuseParams);
+
+    if (NT_SUCCESS(status))
+    {
+        status = WdfIoTargetFormatRequestForInternalIoctlOthers(deviceExtension->IoTarget, 
+                                                                Slot->Request,
+                                                                IOCTL_SCSI_EXECUTE_IN,
+                                                                NULL, NULL,
+                                                                NULL, NULL,
+                                                                NULL, NULL);
+    }
+
+    if (!NT_SUCCESS(status))
+    {
+        TracePrint((TRACE_LEVEL_ERROR, TRACE_FLAG_GENERAL,  
+                   "ScratchBuffer_ReadPipelineSendSlot: failed to format request, %!STATUS!\n",
+                   status));
+        return status;
+    }
+
+    if (FirstTry)
+    {
+        RequestClearSendTime(Slot->Request);
+    }
+
+    requestContext->OriginalRequest = pipeline->OriginalRequest;
+    requestContext->DeviceExtension = deviceExtension;
+
+    RtlZeroMemory(&Slot->Sense, sizeof(SENSE_DATA));
+    RtlZeroMemory(&Slot->Srb, sizeof(SCSI_REQUEST_BLOCK));
+
+    startingOffset.QuadPart = readWriteContext->StartingOffset.QuadPart + Slot->Offset;
+    dataBuffer = readWriteContext->DataBuffer + Slot->Offset;
+
+    ScratchBuffer_BuildReadWriteSrb(deviceExtension,
+                                    pipeline->OriginalRequest,
+                                    irp,
+                                    &Slot->Srb,
+                                    &Slot->Sense,
+                                    startingOffset,
+                                    Slot->Length,
+                                    dataBuffer,
+                                    TRUE);
+
+    // Each slot maps its own part of the original buffer.
+    if (Slot->PartialMdlIsBuilt != FALSE)
+    {
+        MmPrepareMdlForReuse(Slot->PartialMdl);
+    }
+
+    IoBuildPartialMdl(originalIrp->MdlAddress, Slot->PartialMdl, dataBuffer, Slot->Length);
+    Slot->PartialMdlIsBuilt = TRUE;
+    irp->MdlAddress = Slot->PartialMdl;
+
+    WdfRequestSetCompletionRoutine(Slot->Request,
+                                   ScratchBuffer_ReadPipelineCompletionRoutine,
+                                   Slot);
+
+    status = RequestSend(deviceExtension,
+                         Slot->Request,
+                         deviceExtension->IoTarget,
+                         0,
+                         NULL);
+
+    return status;
+}
+
+
+VOID
+ScratchBuffer_ReadPipelineComplete(
+    _Inout_ PCDROM_READ_PIPELINE    Pipeline
+    )
+/*++
+
+Routine Description:
+
+    Completes the original read once the last slot of the pipeline is done.
+    The transferred byte count stops at the lowest transfer that failed.
+
+Arguments:
+
+    Pipeline - the read pipeline
+
+Return Value:
+
+    none
+
+--*/
+{
+    PCDROM_DEVICE_EXTENSION             deviceExtension = Pipeline->DeviceExtension;
+    PCDROM_SCRATCH_READ_WRITE_CONTEXT   readWriteContext = &deviceExtension->ScratchContext.ScratchReadWriteContext;
+    WDFREQUEST                          originalRequest = Pipeline->OriginalRequest;
+    NTSTATUS                            status = Pipeline->FailedStatus;
+    ULONG                               i;
+
+    for (i = 0; i < CDROM_READ_PIPELINE_DEPTH; i++)
+    {
+        PCDROM_READ_PIPELINE_SLOT slot = &Pipeline->Slots[i];
+
+        if (slot->PartialMdlIsBuilt != FALSE)
+        {
+            MmPrepareMdlForReuse(slot->PartialMdl);
+            slot->PartialMdlIsBuilt = FALSE;
+        }
+    }
+
+    readWriteContext->TransferedBytes = Pipeline->FailedOffset;
+    readWriteContext->PacketsCount = 0;
+
+    Pipeline->OriginalRequest = NULL;
+
+    ScratchBuffer_EndUse(deviceExtension);
+
+    RequestCompletion(deviceExtension, originalRequest, status, readWriteContext->TransferedBytes);
+}
+
+
+VOID
+ScratchBuffer_ReadPipelineSlotDone(
+    _Inout_ PCDROM_READ_PIPELINE_SLOT   Slot,
+    _In_ NTSTATUS                       Status,
+    _In_ ULONG                          BytesTransferred
+    )
+/*++
+
+Routine Description:
+
+    Accounts the finished transfer of a slot. As long as nothing has failed,
+    the slot is handed the next part of the read and sent again, so that
+    the pipeline stays full; otherwise the slot retires, and the last slot
+    to retire completes the original read.
+
+Arguments:
+
+    Slot - the pipeline slot
+    Status - final status of the slot's transfer, after any retries
+    BytesTransferred - number of bytes the transfer returned
+
+Return Value:
+
+    none
+
+--*/
+{
+    PCDROM_READ_PIPELINE                pipeline = Slot->Pipeline;
+    PCDROM_SCRATCH_READ_WRITE_CONTEXT   readWriteContext = &pipeline->DeviceExtension->ScratchContext.ScratchReadWriteContext;
+    BOOLEAN                             sendNext;
+    BOOLEAN                             complete = FALSE;
+    KIRQL                               oldIrql;
+
+    do
+    {
+        sendNext = FALSE;
+
+        KeAcquireSpinLock(&pipeline->Lock, &oldIrql);
+
+        if (!NT_SUCCESS(Status) || (BytesTransferred < Slot->Length))
+        {
+            ULONG failedOffset = Slot->Offset + (NT_SUCCESS(Status) ? BytesTransferred : 0);
+
+            if (failedOffset < pipeline->FailedOffset)
+            {
+                pipeline->FailedOffset = failedOffset;
+                pipeline->FailedStatus = Status;
+            }
+        }
+
+        if ((pipeline->FailedOffset == readWriteContext->EntireXferLen) &&
+            (pipeline->IssuedBytes < readWriteContext->EntireXferLen))
+        {
+            Slot->Offset = pipeline->IssuedBytes;
+            Slot->Length = min((readWriteContext->EntireXferLen - pipeline->IssuedBytes), readWriteContext->MaxLength);
+            pipeline->IssuedBytes += Slot->Length;
+            sendNext = TRUE;
+        }
+        else
+        {
+            pipeline->OutstandingCount--;
+            complete = (pipeline->OutstandingCount == 0);
+        }
+
+        KeReleaseSpinLock(&pipeline->Lock, oldIrql);
+
+        if (sendNext)
+        {
+            Status = ScratchBuffer_ReadPipelineSendSlot(Slot, TRUE);
+            BytesTransferred = 0;
+        }
+
+    } while (sendNext && !NT_SUCCESS(Status));
+
+    if (complete)
+    {
+        ScratchBuffer_ReadPipelineComplete(pipeline);
+    }
+}
+
+
+NTSTATUS
+ScratchBuffer_PerformPipelinedRead(
+    _In_ PCDROM_DEVICE_EXTENSION  DeviceExtension
+    )
+/*++
+
+Routine Description:
+
+    This function starts a read that needs more than one transfer on the
+    read pipeline: up to CDROM_READ_PIPELINE_DEPTH transfers are kept
+    outstanding until the whole read is done. The scratch read/write
+    context must have been set up for the read, and the scratch buffer
+    must be in use; it is released when the read completes.
+
+Arguments:
+
+    DeviceExtension - Device extension
+
+Return Value:
+
+    STATUS_SUCCESS - the original read will be completed by the pipeline
+
+--*/
+{
+    PCDROM_READ_PIPELINE                pipeline = &DeviceExtension->ScratchContext.ReadPipeline;
+    PCDROM_SCRATCH_READ_WRITE_CONTEXT   readWriteContext = &DeviceExtension->ScratchContext.ScratchReadWriteContext;
+    PCDROM_REQUEST_CONTEXT              requestContext = RequestGetContext(DeviceExtension->ScratchContext.ScratchRequest);
+    BOOLEAN                             complete = FALSE;
+    KIRQL                               oldIrql;
+    ULONG                               i;
+
+    NT_ASSERT(pipeline->Allocated);
+    NT_ASSERT(pipeline->OriginalRequest == NULL);
+    NT_ASSERT(readWriteContext->IsRead);
+
+    pipeline->OriginalRequest = requestContext->OriginalRequest;
+    pipeline->IssuedBytes = 0;
+    pipeline->FailedOffset = readWriteContext->EntireXferLen;
+    pipeline->FailedStatus = STATUS_SUCCESS;
+
+    // Hold the pipeline open until all the slots have been started.
+    pipeline->OutstandingCount = 1;
+
+    for (i = 0; i < CDROM_READ_PIPELINE_DEPTH; i++)
+    {
+        PCDROM_READ_PIPELINE_SLOT   slot = &pipeline->Slots[i];
+        BOOLEAN                     sendSlot = FALSE;
+        NTSTATUS                    status;
+
+        KeAcquireSpinLock(&pipeline->Lock, &oldIrql);
+
+        if ((pipeline->FailedOffset == readWriteContext->EntireXferLen) &&
+            (pipeline->IssuedBytes < readWriteContext->EntireXferLen))
+        {
+            slot->Offset = pipeline->IssuedBytes;
+            slot->Length = min((readWriteContext->EntireXferLen - pipeline->IssuedBytes), readWriteContext->MaxLength);
+            pipeline->IssuedBytes += slot->Length;
+            pipeline->OutstandingCount++;
+            sendSlot = TRUE;
+        }
+
+        KeReleaseSpinLock(&pipeline->Lock, oldIrql);
+
+        if (!sendSlot)
+        {
+            break;
+        }
+
+        status = ScratchBuffer_ReadPipelineSendSlot(slot, TRUE);
+
+        if (!NT_SUCCESS(status))
+        {
+            ScratchBuffer_ReadPipelineSlotDone(slot, status, 0);
+        }
+    }
+
+    KeAcquireSpinLock(&pipeline->Lock, &oldIrql);
+    pipeline->OutstandingCount--;
+    complete = (pipeline->OutstandingCount == 0);
+    KeReleaseSpinLock(&pipeline->Lock, oldIrql);
+
+    if (complete)
+    {
+        ScratchBuffer_ReadPipelineComplete(pipeline);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+ScratchBuffer_ReadPipelineRetryTimerRoutine(
+    struct _KDPC *Dpc,
+    PVOID         DeferredContext,
+    PVOID         SystemArgument1,
+    PVOID         SystemArgument2
+    )
+/*++
+
+Routine Description:
+
+    Timer routine for retrying the transfer of a read pipeline slot.
+
+Arguments:
+
+    DeferredContext - the pipeline slot
+
+Return Value:
+
+    none  
+
+--*/
+{
+    PCDROM_READ_PIPELINE_SLOT   slot = (PCDROM_READ_PIPELINE_SLOT)DeferredContext;
+    NTSTATUS                    status;
+
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);  
+
+    if (slot == NULL)
+    {
+        // This is impossible, but definition of KDEFERRED_ROUTINE allows optional argument,
+        // and thus OACR will complain.
+
+        return;
+    }
+
+    // A retry of the same transfer, so the second parameter is always FALSE
+    status = ScratchBuffer_ReadPipelineSendSlot(slot, FALSE);
+
+    if (!NT_SUCCESS(status))
+    {
+        ScratchBuffer_ReadPipelineSlotDone(slot, status, 0);
+    }
+}
+
+
+VOID
+ScratchBuffer_ReadPipelineCompletionRoutine(
+    _In_ WDFREQUEST  Request,
+    _In_ WDFIOTARGET  Target,
+    _In_ PWDF_REQUEST_COMPLETION_PARAMS  Params,
+    _In_ WDFCONTEXT  Context
+    )
+/*++
+
+Routine Description:
+
+    Completion routine of a read pipeline slot. Failed transfers are retried
+    as the sense data dictates, exactly like the transfers of the scratch SRB.
+
+Arguments:
+    Request - WDF request
+    Target - The IO target the request was completed by.
+    Params - the request completion parameters
+    Context - the pipeline slot
+
+Return Value:
+
+    none  
+
+--*/
+{
+    PCDROM_READ_PIPELINE_SLOT   slot = (PCDROM_READ_PIPELINE_SLOT)Context;
+    PCDROM_DEVICE_EXTENSION     deviceExtension = slot->Pipeline->DeviceExtension;
+    NTSTATUS                    status = STATUS_SUCCESS;
+    ULONG                       bytesTransferred = 0;
+
+    UNREFERENCED_PARAMETER(Params);
+    UNREFERENCED_PARAMETER(Target);
+
+    if (!NT_SUCCESS(WdfRequestGetStatus(Request)))
+    {
+        TracePrint((TRACE_LEVEL_WARNING, TRACE_FLAG_GENERAL,
+                   "ScratchBuffer_ReadPipelineCompletionRoutine: %lx\n",
+                    WdfRequestGetStatus(Request)
+                    ));
+    }
+
+    if ((slot->Srb.SrbStatus == SRB_STATUS_ABORTED) &&
+        (slot->Srb.InternalStatus == STATUS_CANCELLED))
+    {
+        // The request has been cancelled, just need to complete it
+        status = STATUS_CANCELLED;
+    }
+    else if (SRB_STATUS(slot->Srb.SrbStatus) != SRB_STATUS_SUCCESS)
+    {
+        // The SCSI command that we sent down has failed, retry it if necessary
+        BOOLEAN shouldRetry = TRUE;
+        LONGLONG retryIn100nsUnits = 0;
+
+        shouldRetry = RequestSenseInfoInterpret(deviceExtension,
+                                                slot->Request,
+                                                &slot->Srb,
+                                                slot->NumRetries,
+                                                &status,
+                                                &retryIn100nsUnits);
+
+        if (shouldRetry)
+        {
+            slot->NumRetries++;
+
+            if (retryIn100nsUnits == 0)
+            {
+                status = ScratchBuffer_ReadPipelineSendSlot(slot, FALSE);
+
+                if (NT_SUCCESS(status))
+                {
+                    // We're not done with the transfer yet
+                    return;
+                }
+            }
+            else
+            {
+                LARGE_INTEGER t;
+
+                // Use negative time to indicate that we want a relative delay
+                t.QuadPart = -retryIn100nsUnits;
+
+                KeSetTimer(&slot->RetryTimer, t, &slot->RetryDpc);
+
+                return;
+            }
+        }
+    }
+    else
+    {
+        // The SCSI command has succeeded
+        bytesTransferred = slot->Srb.DataTransferLength;
+    }
+
+    ScratchBuffer_ReadPipelineSlotDone(slot, status, bytesTransferred);
+}
 
@@ -81,6 +81,36 @@ ScratchBuffer_PerformNextReadWrite(
     _In_ BOOLEAN                  FirstTry
     );
 
+VOID
+ScratchBuffer_BuildReadWriteSrb(
+    _In_    PCDROM_DEVICE_EXTENSION     DeviceExtension,
+    _In_    WDFREQUEST                  OriginalRequest,
+    _In_    PIRP                        Irp,
+    _Out_   PSCSI_REQUEST_BLOCK         Srb,
+    _In_    PSENSE_DATA                 SenseBuffer,
+    _In_    LARGE_INTEGER               StartingOffset,
+    _In_    ULONG                       RequiredLength,
+    _In_    UCHAR*                      DataBuffer,
+    _In_    BOOLEAN                     IsReadRequest
+    );
+
+_IRQL_requires_max_(APC_LEVEL)
+VOID
+ScratchBuffer_AllocateReadPipeline(
+    _Inout_ PCDROM_DEVICE_EXTENSION DeviceExtension
+    );
+
+_IRQL_requires_max_(APC_LEVEL)
+VOID
+ScratchBuffer_DeallocateReadPipeline(
+    _Inout_ PCDROM_DEVICE_EXTENSION DeviceExtension
+    );
+
+NTSTATUS
+ScratchBuffer_PerformPipelinedRead(
+    _In_ PCDROM_DEVICE_EXTENSION  DeviceExtension
+    );
+
 #if DBG
     #define ScratchBuffer_BeginUse(context) ScratchBuffer_BeginUseX((context), __FILE__, __LINE__)
 #else
@@ -87,6 +87,9 @@ ULONG ClassMaxInterleavePerCriticalIo = CLASS_MAX_INTERLEAVE_PER_CRITICAL_IO;
 CONST LARGE_INTEGER Magic10000 = {0xe219652c, 0xd1b71758};
 GUID StoragePredictFailureDPSGuid = WDI_STORAGE_PREDICT_FAILURE_DPS_GUID;
 
+// {77E8CA60-C505-4A9B-A200-35F7CEA3E7BE}
+GUID ClassLatencyHistogramGuid = { 0x77e8ca60, 0xc505, 0x4a9b, { 0xa2, 0x00, 0x35, 0xf7, 0xce, 0xa3, 0xe7, 0xbe } };
+
 #define FirstDriveLetter 'C'
 #define LastDriveLetter  'Z'
 
@@ -2174,6 +2177,20 @@ NTSTATUS ClassPnpStartDevice(IN PDEVICE_OBJECT DeviceObject)
                         ClassDetermineTokenOperationCommandSupport(DeviceObject);
                     }
 
+                    //
+                    // See if the user wants offload writes to keep more than one
+                    // WRITE USING TOKEN in flight.
+                    //  1 = One at a time (default)
+                    //  2 - MAX_OFFLOAD_WRITE_PIPELINE_DEPTH = Pipelined
+                    //
+                    fdoExtension->PrivateFdoData->OffloadWritePipelineDepth = 1;
+                    ClassGetDeviceParameter(fdoExtension,
+                                            CLASSP_REG_SUBKEY_NAME,
+                                            CLASSP_REG_OFFLOAD_WRITE_PIPELINE_DEPTH,
+                                            &fdoExtension->PrivateFdoData->OffloadWritePipelineDepth);
+                    fdoExtension->PrivateFdoData->OffloadWritePipelineDepth =
+                        MAX(1, MIN(fdoExtension->PrivateFdoData->OffloadWritePipelineDepth, MAX_OFFLOAD_WRITE_PIPELINE_DEPTH));
+
                     //
                     // See if the user has specified a particular QERR override
                     // mode. "Override" meaning setting QERR = 0 via Mode Select.
@@ -2573,7 +2590,11 @@ NTSTATUS ClassReadWrite(IN PDEVICE_OBJECT DeviceObject, IN PIRP Irp)
                             ClassAcquireRemoveLock(DeviceObject, (PVOID)&uniqueAddr);
 
                             ClasspMarkIrpAsIdle(Irp, FALSE);
-                            status = ServiceTransferRequest(DeviceObject, Irp, FALSE);
+                            if (ClasspCoalesceTransferRequest(DeviceObject, Irp)) {
+                                status = STATUS_PENDING;
+                            } else {
+                                status = ServiceTransferRequest(DeviceObject, Irp, FALSE);
+                            }
                             if (fdoData->IdlePrioritySupported == TRUE) {
                                 fdoData->LastIoTime = ClasspGetCurrentTime(NULL);
                                 fdoData->IdleTicks = 0;
@@ -13829,6 +13850,7 @@ Return Value:
 
     offloadReadContext->Fdo = Fdo;
     offloadReadContext->OffloadReadDsmIrp = Irp;
+    offloadReadContext->OperationStartTime = KeQueryInterruptTime();
 
     //
     // The buffer for the commands is after the offloadReadContext.
@@ -14195,6 +14217,11 @@ Return Value:
                     entireXferLen,
                     OffloadReadContext->ListIdentifier));
 
+        InterlockedIncrement64(&fdoExt->PrivateFdoData->OffloadStatistics.PopulateTokenRequests);
+        InterlockedAdd64(&fdoExt->PrivateFdoData->OffloadStatistics.PopulateTokenBytes, (LONGLONG)totalBytesProcessed);
+        InterlockedAdd64(&fdoExt->PrivateFdoData->OffloadStatistics.PopulateTokenTime,
+                         (LONGLONG)(KeQueryInterruptTime() - OffloadReadContext->OperationStartTime));
+
         if (totalBytesProcessed < entireXferLen) {
             SET_FLAG(((PSTORAGE_OFFLOAD_READ_OUTPUT)dsmAttributes)->OffloadReadFlags, STORAGE_OFFLOAD_READ_RANGE_TRUNCATED);
         }
@@ -15021,6 +15048,13 @@ Return Value:
     //
     // Given the above, we're going with the second approach.
     //
+    // If the device is configured with an OffloadWritePipelineDepth greater than 1 though,
+    // a request that needs more than one WriteUsingToken is carved into slices of one
+    // WriteUsingToken each, and up to that many slices are written at the same time, each
+    // one following the second approach on its own. The amount reported as written is the
+    // prefix of slices that were written in full, plus whatever the first short slice
+    // managed to write.
+    //
 
     NT_ASSERT(status == STATUS_SUCCESS); // so far
 
@@ -15034,7 +15068,21 @@ Return Value:
     offloadWriteContext->EntireXferLen = entireXferLen;
 
     IoMarkIrpPending(Irp);
-    ClasspContinueOffloadWrite(offloadWriteContext);
+
+    if ((fdoExt->PrivateFdoData->OffloadWritePipelineDepth > 1) &&
+        (offloadWriteContext->TotalRequestSizeSectors > maxLbaCount)) {
+
+        KeInitializeSpinLock(&offloadWriteContext->PipelineLock);
+        offloadWriteContext->PipelineDepth = fdoExt->PrivateFdoData->OffloadWritePipelineDepth;
+        offloadWriteContext->PipelineStatus = STATUS_SUCCESS;
+        offloadWriteContext->PipelineReferences = 1;
+
+        ClasspStartOffloadWriteSlices(offloadWriteContext);
+
+    } else {
+
+        ClasspContinueOffloadWrite(offloadWriteContext);
+    }
 
     status = STATUS_PENDING;
     goto __ClasspServiceWriteUsingTokenTransferRequest_Exit;
@@ -15722,6 +15770,31 @@ Return Value:
     totalSectorsProcessed = OffloadWriteContext->TotalSectorsProcessed;
     status = CompletionCausingStatus;
 
+    //
+    // A slice of a pipelined offload write only reports back to its parent,
+    // which completes the upper irp when the last slice is done.
+    //
+    if (OffloadWriteContext->Parent != NULL) {
+
+        POFFLOAD_WRITE_CONTEXT parent = OffloadWriteContext->Parent;
+
+        ClasspOffloadWriteSliceDone(parent,
+                                    OffloadWriteContext->SliceIndex,
+                                    *totalSectorsProcessedSuccessfully,
+                                    *tokenInvalidated,
+                                    status);
+
+        ClasspCleanupOffloadWriteContext(OffloadWriteContext);
+        OffloadWriteContext = NULL;
+
+        //
+        // Hand this slice's pipeline reference over to the next slices.
+        //
+        ClasspStartOffloadWriteSlices(parent);
+
+        return;
+    }
+
     ((PSTORAGE_OFFLOAD_WRITE_OUTPUT)dsmAttributes)->OffloadWriteFlags = 0;
     ((PSTORAGE_OFFLOAD_WRITE_OUTPUT)dsmAttributes)->Reserved = 0;
 
@@ -15765,6 +15838,13 @@ Return Value:
         }
     }
 
+    if (totalBytesProcessed > 0) {
+        InterlockedIncrement64(&fdoExt->PrivateFdoData->OffloadStatistics.WriteUsingTokenRequests);
+        InterlockedAdd64(&fdoExt->PrivateFdoData->OffloadStatistics.WriteUsingTokenBytes, (LONGLONG)totalBytesProcessed);
+        InterlockedAdd64(&fdoExt->PrivateFdoData->OffloadStatistics.WriteUsingTokenTime,
+                         (LONGLONG)(KeQueryInterruptTime() - OffloadWriteContext->OperationStartTime));
+    }
+
     irp->IoStatus.Information = sizeof(STORAGE_OFFLOAD_WRITE_OUTPUT);
 
     ClasspCompleteOffloadRequest(fdo, irp, status);
@@ -15809,6 +15889,326 @@ Return Value:
 }
 
 
+VOID
+ClasspStartOffloadWriteSlices(
+    _In_ POFFLOAD_WRITE_CONTEXT OffloadWriteContext
+    )
+
+/*++
+
+Routine description:
+
+    This routine starts as many slices of a pipelined offload write as the
+    pipeline depth allows.  Each slice covers up to MaxLbaCount sectors and
+    MaxBlockDescrCount data set ranges of the overall request, and is written
+    by its own child OFFLOAD_WRITE_CONTEXT via ClasspContinueOffloadWrite().
+
+    No new slices are started once a slice has come up short, or once the
+    offload write operation has run for MAX_TARGET_DURATION.
+
+    The caller must hold a reference on the pipeline (each slice in flight
+    holds one), which this routine drops.  Dropping the last reference
+    completes the offload write operation.
+
+Arguments:
+
+    OffloadWriteContext - Pointer to the parent OFFLOAD_WRITE_CONTEXT of the
+        pipelined offload write operation.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    ULONGLONG bytesPerSector;
+    ULONGLONG bytesToDo;
+    PDEVICE_DATA_SET_RANGE dataSetRanges;
+    PDEVICE_OBJECT fdo;
+    PFUNCTIONAL_DEVICE_EXTENSION fdoExt;
+    ULONG i;
+    KIRQL oldIrql;
+    BOOLEAN pipelineDone;
+    POFFLOAD_WRITE_CONTEXT sliceContext;
+    ULONG sliceDataSetRangeIndex;
+    ULONGLONG sliceDataSetRangeByteOffset;
+    ULONGLONG sliceBytesLeft;
+    ULONG sliceIndex;
+    PDEVICE_DATA_SET_RANGE sliceRanges;
+    ULONG sliceRangesCount;
+    ULONGLONG sliceSectors;
+    ULONGLONG sliceStartSector;
+    ULONG sliceRangesOffset;
+
+    fdo = OffloadWriteContext->Fdo;
+    fdoExt = fdo->DeviceExtension;
+    bytesPerSector = fdoExt->DiskGeometry.BytesPerSector;
+    dataSetRanges = OffloadWriteContext->DataSetRanges;
+    sliceRangesOffset = ALIGN_UP_BY(OffloadWriteContext->BufferLength, TYPE_ALIGNMENT(DEVICE_DATA_SET_RANGE));
+
+    for (;;) {
+
+        KeAcquireSpinLock(&OffloadWriteContext->PipelineLock, &oldIrql);
+
+        if (!OffloadWriteContext->PipelineStopped &&
+            (KeQueryInterruptTime() - OffloadWriteContext->OperationStartTime) >= MAX_TARGET_DURATION) {
+
+            TracePrint((TRACE_LEVEL_WARNING,
+                        TRACE_FLAG_IOCTL,
+                        "ClasspStartOffloadWriteSlices (%p): Truncating write (Irp %p) because of max-duration-rule.\n",
+                        fdo,
+                        OffloadWriteContext->OffloadWriteDsmIrp));
+
+            OffloadWriteContext->PipelineStopped = TRUE;
+        }
+
+        if (OffloadWriteContext->PipelineStopped ||
+            (OffloadWriteContext->DataSetRangeIndex == OffloadWriteContext->DataSetRangesCount) ||
+            ((OffloadWriteContext->NextSliceIndex - OffloadWriteContext->FirstPendingSliceIndex) >= OffloadWriteContext->PipelineDepth)) {
+
+            //
+            // Nothing more to start for now.  If the pipeline is full, a
+            // slice in flight will call back here when it is done.
+            //
+            NT_ASSERT(OffloadWriteContext->PipelineReferences > 0);
+            OffloadWriteContext->PipelineReferences -= 1;
+            pipelineDone = (OffloadWriteContext->PipelineReferences == 0);
+
+            KeReleaseSpinLock(&OffloadWriteContext->PipelineLock, oldIrql);
+
+            if (pipelineDone) {
+                ClasspCompleteOffloadWrite(OffloadWriteContext, OffloadWriteContext->PipelineStatus);
+            }
+            break;
+        }
+
+        //
+        // Carve the next slice off the remainder of the data set ranges.
+        //
+        sliceDataSetRangeIndex = OffloadWriteContext->DataSetRangeIndex;
+        sliceDataSetRangeByteOffset = OffloadWriteContext->DataSetRangeByteOffset;
+        sliceBytesLeft = OffloadWriteContext->MaxLbaCount * bytesPerSector;
+        sliceRangesCount = 0;
+
+        while ((OffloadWriteContext->DataSetRangeIndex < OffloadWriteContext->DataSetRangesCount) &&
+               (sliceBytesLeft != 0) &&
+               (sliceRangesCount < OffloadWriteContext->MaxBlockDescrCount)) {
+
+            bytesToDo = dataSetRanges[OffloadWriteContext->DataSetRangeIndex].LengthInBytes - OffloadWriteContext->DataSetRangeByteOffset;
+            bytesToDo = MIN(bytesToDo, sliceBytesLeft);
+
+            sliceRangesCount += 1;
+            sliceBytesLeft -= bytesToDo;
+            OffloadWriteContext->DataSetRangeByteOffset += bytesToDo;
+
+            if (OffloadWriteContext->DataSetRangeByteOffset == dataSetRanges[OffloadWriteContext->DataSetRangeIndex].LengthInBytes) {
+                OffloadWriteContext->DataSetRangeIndex += 1;
+                OffloadWriteContext->DataSetRangeByteOffset = 0;
+            }
+        }
+
+        sliceSectors = (OffloadWriteContext->MaxLbaCount * bytesPerSector - sliceBytesLeft) / bytesPerSector;
+        sliceStartSector = OffloadWriteContext->SectorsSliced;
+        OffloadWriteContext->SectorsSliced += sliceSectors;
+
+        sliceIndex = OffloadWriteContext->NextSliceIndex;
+        OffloadWriteContext->NextSliceIndex += 1;
+        OffloadWriteContext->PipelineReferences += 1;
+
+        OffloadWriteContext->Slices[sliceIndex % OffloadWriteContext->PipelineDepth].SectorsRequested = sliceSectors;
+        OffloadWriteContext->Slices[sliceIndex % OffloadWriteContext->PipelineDepth].SectorsWritten = 0;
+        OffloadWriteContext->Slices[sliceIndex % OffloadWriteContext->PipelineDepth].Status = STATUS_PENDING;
+        OffloadWriteContext->Slices[sliceIndex % OffloadWriteContext->PipelineDepth].Done = FALSE;
+
+        KeReleaseSpinLock(&OffloadWriteContext->PipelineLock, oldIrql);
+
+        NT_ASSERT(sliceSectors != 0);
+
+        //
+        // The child context is laid out like the parent (the SCSI buffer
+        // immediately follows the struct), with its data set ranges after the buffer.
+        //
+        sliceContext = ExAllocatePoolWithTag(
+            NonPagedPoolNx,
+            sizeof(OFFLOAD_WRITE_CONTEXT) + sliceRangesOffset + sliceRangesCount * sizeof(DEVICE_DATA_SET_RANGE),
+            CLASSPNP_POOL_TAG_TOKEN_OPERATION);
+
+        if (sliceContext != NULL) {
+
+            RtlZeroMemory(sliceContext, sizeof(OFFLOAD_WRITE_CONTEXT));
+
+            sliceContext->WriteUsingTokenMdl = ClasspBuildDeviceMdl(sliceContext + 1, OffloadWriteContext->BufferLength, FALSE);
+            if (sliceContext->WriteUsingTokenMdl == NULL) {
+                FREE_POOL(sliceContext);
+            }
+        }
+
+        if (sliceContext == NULL) {
+
+            TracePrint((TRACE_LEVEL_ERROR,
+                        TRACE_FLAG_IOCTL,
+                        "ClasspStartOffloadWriteSlices (%p): Failed to allocate context for slice %u.\n",
+                        fdo,
+                        sliceIndex));
+
+            //
+            // This stops the pipeline.  The slice's reference can't be the
+            // last one, since the caller's is still held.
+            //
+            ClasspOffloadWriteSliceDone(OffloadWriteContext,
+                                        sliceIndex,
+                                        0,
+                                        FALSE,
+                                        STATUS_INSUFFICIENT_RESOURCES);
+
+            KeAcquireSpinLock(&OffloadWriteContext->PipelineLock, &oldIrql);
+            OffloadWriteContext->PipelineReferences -= 1;
+            NT_ASSERT(OffloadWriteContext->PipelineReferences > 0);
+            KeReleaseSpinLock(&OffloadWriteContext->PipelineLock, oldIrql);
+            continue;
+        }
+
+        sliceRanges = Add2Ptr(sliceContext + 1, sliceRangesOffset);
+
+        for (i = 0, sliceBytesLeft = sliceSectors * bytesPerSector; i < sliceRangesCount; i++) {
+
+            bytesToDo = dataSetRanges[sliceDataSetRangeIndex].LengthInBytes - sliceDataSetRangeByteOffset;
+            bytesToDo = MIN(bytesToDo, sliceBytesLeft);
+
+            sliceRanges[i].StartingOffset = dataSetRanges[sliceDataSetRangeIndex].StartingOffset + sliceDataSetRangeByteOffset;
+            sliceRanges[i].LengthInBytes = bytesToDo;
+
+            sliceBytesLeft -= bytesToDo;
+            sliceDataSetRangeIndex += 1;
+            sliceDataSetRangeByteOffset = 0;
+        }
+
+        sliceContext->Fdo = fdo;
+        sliceContext->OffloadWriteDsmIrp = OffloadWriteContext->OffloadWriteDsmIrp;
+        sliceContext->OperationStartTime = OffloadWriteContext->OperationStartTime;
+        sliceContext->DsmAttributes = OffloadWriteContext->DsmAttributes;
+        sliceContext->OffloadWriteParameters = OffloadWriteContext->OffloadWriteParameters;
+        sliceContext->DataSetRanges = sliceRanges;
+        sliceContext->DataSetRangesCount = sliceRangesCount;
+        sliceContext->LogicalBlockOffset = OffloadWriteContext->LogicalBlockOffset + sliceStartSector;
+        sliceContext->TotalRequestSizeSectors = sliceSectors;
+        sliceContext->EntireXferLen = sliceSectors * bytesPerSector;
+        sliceContext->MaxBlockDescrCount = OffloadWriteContext->MaxBlockDescrCount;
+        sliceContext->MaxLbaCount = OffloadWriteContext->MaxLbaCount;
+        sliceContext->BufferLength = OffloadWriteContext->BufferLength;
+        sliceContext->ReceiveTokenInformationBufferLength = OffloadWriteContext->ReceiveTokenInformationBufferLength;
+        sliceContext->Parent = OffloadWriteContext;
+        sliceContext->SliceIndex = sliceIndex;
+
+        TracePrint((TRACE_LEVEL_INFORMATION,
+                    TRACE_FLAG_IOCTL,
+                    "ClasspStartOffloadWriteSlices (%p): Starting slice %u of Irp %p for %I64u bytes at token offset %I64u.\n",
+                    fdo,
+                    sliceIndex,
+                    OffloadWriteContext->OffloadWriteDsmIrp,
+                    sliceContext->EntireXferLen,
+                    sliceStartSector * bytesPerSector));
+
+        ClasspContinueOffloadWrite(sliceContext);
+    }
+
+    return;
+}
+
+
+VOID
+ClasspOffloadWriteSliceDone(
+    _In_ POFFLOAD_WRITE_CONTEXT OffloadWriteContext,
+    _In_ ULONG SliceIndex,
+    _In_ ULONGLONG SectorsWritten,
+    _In_ BOOLEAN TokenInvalidated,
+    _In_ NTSTATUS CompletionCausingStatus
+    )
+
+/*++
+
+Routine description:
+
+    This routine records the outcome of one slice of a pipelined offload
+    write, and adds the slices that are now known to follow a run of fully
+    written slices to the total written by the operation.
+
+    Since slices complete out of order, a slice that comes up short stops the
+    count: the sectors written by later slices are not reported, even though
+    the target may have written them too.  That's harmless, since the caller
+    only continues the copy from the reported length.
+
+    The slice's reference on the pipeline is not dropped; the caller is
+    responsible for continuing the offload write operation with it, via
+    ClasspStartOffloadWriteSlices().
+
+Arguments:
+
+    OffloadWriteContext - Pointer to the parent OFFLOAD_WRITE_CONTEXT of the
+        pipelined offload write operation.
+
+    SliceIndex - The slice that is done.
+
+    SectorsWritten - The number of sectors the slice wrote successfully.
+
+    TokenInvalidated - Whether the target reported that the token is no
+        longer valid.
+
+    CompletionCausingStatus - Status the slice completed with.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    KIRQL oldIrql;
+    POFFLOAD_WRITE_SLICE slice;
+
+    KeAcquireSpinLock(&OffloadWriteContext->PipelineLock, &oldIrql);
+
+    slice = &OffloadWriteContext->Slices[SliceIndex % OffloadWriteContext->PipelineDepth];
+    slice->SectorsWritten = SectorsWritten;
+    slice->Status = CompletionCausingStatus;
+    slice->Done = TRUE;
+
+    if (TokenInvalidated) {
+        OffloadWriteContext->TokenInvalidated = TRUE;
+    }
+
+    if (!NT_SUCCESS(CompletionCausingStatus) || (SectorsWritten < slice->SectorsRequested)) {
+        OffloadWriteContext->PipelineStopped = TRUE;
+    }
+
+    while ((OffloadWriteContext->FirstPendingSliceIndex != OffloadWriteContext->NextSliceIndex) &&
+           OffloadWriteContext->Slices[OffloadWriteContext->FirstPendingSliceIndex % OffloadWriteContext->PipelineDepth].Done) {
+
+        slice = &OffloadWriteContext->Slices[OffloadWriteContext->FirstPendingSliceIndex % OffloadWriteContext->PipelineDepth];
+
+        if (!OffloadWriteContext->PipelineTruncated) {
+
+            OffloadWriteContext->TotalSectorsProcessedSuccessfully += slice->SectorsWritten;
+
+            if (slice->SectorsWritten < slice->SectorsRequested) {
+                OffloadWriteContext->PipelineTruncated = TRUE;
+                OffloadWriteContext->PipelineStatus = slice->Status;
+            }
+        }
+
+        slice->Done = FALSE;
+        OffloadWriteContext->FirstPendingSliceIndex += 1;
+    }
+
+    NT_ASSERT(OffloadWriteContext->TotalSectorsProcessedSuccessfully <= OffloadWriteContext->TotalRequestSizeSectors);
+
+    KeReleaseSpinLock(&OffloadWriteContext->PipelineLock, oldIrql);
+
+    return;
+}
+
+
 _IRQL_requires_same_
 VOID
 ClasspReceiveWriteUsingTokenInformation(
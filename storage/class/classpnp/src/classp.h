@@ -107,12 +107,18 @@ extern ULONG ClassMaxInterleavePerCriticalIo;
 #define CLASSP_REG_IDLE_INTERVAL_NAME               (L"IdleInterval")
 #define CLASSP_REG_IDLE_ACTIVE_MAX                  (L"IdleOutstandingIoMax")
 #define CLASSP_REG_IDLE_PRIORITY_SUPPORTED          (L"IdlePrioritySupported")
+#define CLASSP_REG_IDLE_BANDWIDTH_LIMIT             (L"IdleBandwidthLimitInKBps")
+#define CLASSP_REG_IDLE_BURST_SIZE                  (L"IdleBurstSizeInKB")
+#define CLASSP_REG_IDLE_DEADLINE                    (L"IdleDeadlineInMilliseconds")
+#define CLASSP_REG_IDLE_LATENCY_TARGET              (L"IdleLatencyTargetInMicroseconds")
 #define CLASSP_REG_ACCESS_ALIGNMENT_NOT_SUPPORTED   (L"AccessAlignmentQueryNotSupported")
 #define CLASSP_REG_DISBALE_IDLE_POWER_NAME          (L"DisableIdlePowerManagement")
 #define CLASSP_REG_IDLE_TIMEOUT_IN_SECONDS          (L"IdleTimeoutInSeconds")
 #define CLASSP_REG_DISABLE_D3COLD                   (L"DisableD3Cold")
 #define CLASSP_REG_QERR_OVERRIDE_MODE               (L"QERROverrideMode")
 #define CLASSP_REG_LEGACY_ERROR_HANDLING            (L"LegacyErrorHandling")
+#define CLASSP_REG_COALESCE_WINDOW                  (L"CoalesceWindowInMicroseconds")
+#define CLASSP_REG_OFFLOAD_WRITE_PIPELINE_DEPTH     (L"OffloadWritePipelineDepth")
 
 #define CLASS_PERF_RESTORE_MINIMUM                  (0x10)
 #define CLASS_ERROR_LEVEL_1                         (0x4)
@@ -182,6 +188,7 @@ extern ULONG ClassMaxInterleavePerCriticalIo;
 #define CLASSPNP_POOL_TAG_LOG_MESSAGE               'mlcS'
 #define CLASSPNP_POOL_TAG_ADDITIONAL_DATA           'DAcS'
 #define CLASSPNP_POOL_TAG_FIRMWARE                  'wFcS'
+#define CLASSPNP_POOL_TAG_COALESCE                  'lCcS'
 
 //
 // Macros related to Token Operation commands
@@ -200,6 +207,7 @@ extern ULONG ClassMaxInterleavePerCriticalIo;
 #define MIN_TOKEN_LIST_IDENTIFIERS                                  256
 #define MAX_TOKEN_LIST_IDENTIFIERS                                  MAXULONG
 #define MAX_NUMBER_BLOCK_DEVICE_DESCRIPTORS                         64
+#define MAX_OFFLOAD_WRITE_PIPELINE_DEPTH                            8
 
 #define REG_DISK_CLASS_CONTROL                                      L"\\REGISTRY\\MACHINE\\SYSTEM\\CurrentControlSet\\Control\\DISK"
 #define REG_MAX_LIST_IDENTIFIER_VALUE                               L"MaximumListIdentifier"
@@ -618,6 +626,35 @@ typedef struct _TRANSFER_PACKET {
 #define MAX_OUTSTANDING_IO_PER_LUN_DEFAULT                  16
 #define MAX_CLEANUP_TRANSFER_PACKETS_AT_ONCE                8192
 
+/*
+ *  The working set of each node's packet pool also follows the number of
+ *  packets that were in use at the same time during the last one to two
+ *  TRANSFER_PACKET_HIGH_WATER_PERIODs, so that a bursty workload doesn't
+ *  have to reallocate its packets on every burst.  Unless the class driver
+ *  set an explicit maximum, this can raise the working set up to
+ *  MAX_ADAPTIVE_WORKINGSET_TRANSFER_PACKETS_FACTOR times LocalMaxWorkingSetTransferPackets.
+ */
+#define TRANSFER_PACKET_HIGH_WATER_PERIOD                   (5 * 1000 * 1000 * 10)  // 5 seconds, in 100ns
+#define MAX_ADAPTIVE_WORKINGSET_TRANSFER_PACKETS_FACTOR     4
+
+/*
+ *  Number of free packets each processor caches in front of the node's
+ *  SLIST, so that the common dequeue/enqueue pair doesn't touch the shared
+ *  list header.
+ */
+#define TRANSFER_PACKET_CACHE_DEPTH                         4
+
+/*
+ *  Limits for the coalescing of LBA-adjacent reads or writes into a single
+ *  transfer (see ClasspCoalesceTransferRequest).  Only requests up to
+ *  COALESCE_MAX_REQUEST_LENGTH bytes are held back, at most
+ *  COALESCE_MAX_REQUESTS of them are merged, and the registry window is
+ *  capped at COALESCE_MAX_WINDOW microseconds.
+ */
+#define COALESCE_MAX_REQUEST_LENGTH                         (64 * 1024)
+#define COALESCE_MAX_REQUESTS                               16
+#define COALESCE_MAX_WINDOW                                 1000
+
 
 
 typedef struct _PNL_SLIST_HEADER {
@@ -625,8 +662,43 @@ typedef struct _PNL_SLIST_HEADER {
     DECLSPEC_CACHEALIGN ULONG NumFreeTransferPackets;
     ULONG NumTotalTransferPackets;
     ULONG DbgPeakNumTransferPackets;
+
+    //
+    // Peak number of packets in use in the current and the previous
+    // TRANSFER_PACKET_HIGH_WATER_PERIOD, and the working set derived from them.
+    //
+    ULONG OutstandingHighWater;
+    ULONG PreviousOutstandingHighWater;
+    ULONGLONG HighWaterPeriodStart;
+    ULONG MinWorkingSetTransferPackets;
+    ULONG MaxWorkingSetTransferPackets;
 } PNL_SLIST_HEADER, *PPNL_SLIST_HEADER;
 
+//
+// Per-processor cache of free transfer packets. The counters are per
+// processor as well so that they don't add a shared cache line to the I/O
+// path; they are summed up when queried through WMI.
+//
+typedef struct _TRANSFER_PACKET_CACHE {
+    DECLSPEC_CACHEALIGN PTRANSFER_PACKET volatile Packets[TRANSFER_PACKET_CACHE_DEPTH];
+    LONGLONG CacheHits;             // Dequeued from this cache
+    LONGLONG FreeListHits;          // Dequeued from the node's SLIST
+    LONGLONG Misses;                // Had to allocate a new packet
+    LONGLONG AllocationFailures;    // ... and the allocation failed
+} TRANSFER_PACKET_CACHE, *PTRANSFER_PACKET_CACHE;
+
+//
+// Per-processor read and write latency histograms of a device, merged on
+// query (see history.c). Bucket N counts the packets that took from 2^N up
+// to 2^(N+1) microseconds, the last bucket everything that took longer.
+//
+#define CLASS_LATENCY_HISTOGRAM_BUCKETS     24
+
+typedef struct _CLASS_LATENCY_HISTOGRAM {
+    DECLSPEC_CACHEALIGN LONGLONG ReadBuckets[CLASS_LATENCY_HISTOGRAM_BUCKETS];
+    LONGLONG WriteBuckets[CLASS_LATENCY_HISTOGRAM_BUCKETS];
+} CLASS_LATENCY_HISTOGRAM, *PCLASS_LATENCY_HISTOGRAM;
+
 //
 // !!! WARNING !!!
 // DO NOT use the following structure in code outside of classpnp
@@ -684,6 +756,12 @@ struct _CLASS_PRIVATE_FDO_DATA {
     ULONG LocalMinWorkingSetTransferPackets;
     ULONG LocalMaxWorkingSetTransferPackets;
 
+    //
+    // Upper bound for the adaptive working set of each node's packet pool.
+    // Equals LocalMaxWorkingSetTransferPackets if the class driver set one.
+    //
+    ULONG AdaptiveMaxWorkingSetTransferPackets;
+
 #if DBG
 
     ULONG MaxOutstandingIOPerLUN;
@@ -744,6 +822,43 @@ struct _CLASS_PRIVATE_FDO_DATA {
     LIST_ENTRY AllTransferPacketsList;
     PPNL_SLIST_HEADER FreeTransferPacketsLists;
 
+    /*
+     *  Per-processor free packet caches, indexed by system-wide processor
+     *  number.  NULL (and a count of 0) if they couldn't be allocated.
+     */
+    PTRANSFER_PACKET_CACHE TransferPacketCaches;
+    ULONG TransferPacketCacheCount;
+
+    /*
+     *  Per-processor latency histograms, indexed by system-wide processor
+     *  number, and the ETW provider instance that reports them.
+     *  NULL (and a count of 0) if they couldn't be allocated.
+     */
+    PCLASS_LATENCY_HISTOGRAM LatencyHistograms;
+    ULONG LatencyHistogramCount;
+    REGHANDLE LatencyEtwHandle;
+
+    /*
+     *  Batch of LBA-adjacent client read/write irps being held back so they
+     *  can be sent down as one transfer.  The irps are linked through
+     *  DriverContext[3] and have ClasspCoalesceCancelRoutine set while they
+     *  are held.  Window is zero if coalescing is disabled; all the other
+     *  fields except OutstandingPackets are protected by Lock.
+     */
+    struct {
+        ULONG Window;                       // in microseconds
+        volatile LONG OutstandingPackets;   // packets submitted and not yet returned
+        KSPIN_LOCK Lock;
+        PIRP FirstIrp;
+        PIRP LastIrp;
+        ULONG IrpCount;
+        ULONG Length;
+        ULONG Pages;
+        LARGE_INTEGER NextOffset;
+        KTIMER Timer;
+        KDPC Dpc;
+    } Coalesce;
+
     /*
      *  Queue for deferred client irps
      */
@@ -927,6 +1042,26 @@ struct _CLASS_PRIVATE_FDO_DATA {
     //
     LONG ActiveIdleIoCount;
 
+    //
+    // Idle I/O scheduler.  Idle requests are issued only while the token
+    // bucket holds bandwidth (BandwidthLimit KB/s, bursting up to BucketSize
+    // bytes) and while the smoothed foreground latency is within
+    // LatencyTarget microseconds.  An idle request that has been queued for
+    // Deadline milliseconds is promoted to normal priority.  A zero limit,
+    // target or deadline disables that check.
+    // Tokens and LastRefillTime are protected by IdleListLock.
+    //
+    struct {
+        ULONG BandwidthLimit;
+        ULONG BucketSize;
+        LONGLONG Tokens;
+        ULONGLONG LastRefillTime;
+        ULONG Deadline;
+        ULONG LatencyTarget;
+        ULONG ForegroundLatency;
+        ULONG PromotedRequests;
+    } IdleScheduler;
+
     //
     // Support for class drivers to extend
     // the interpret sense information routine
@@ -961,6 +1096,25 @@ struct _CLASS_PRIVATE_FDO_DATA {
     //
     BOOLEAN DisableThrottling;
 
+    //
+    // Number of WRITE USING TOKEN commands an offload write may keep in
+    // flight (1 means the commands are sent one at a time).
+    //
+    ULONG OffloadWritePipelineDepth;
+
+    //
+    // Per-phase offload statistics, reported through WMI.  Time is the
+    // sum of the durations of the operations, in 100ns units.
+    //
+    struct {
+        LONGLONG PopulateTokenRequests;
+        LONGLONG PopulateTokenBytes;
+        LONGLONG PopulateTokenTime;
+        LONGLONG WriteUsingTokenRequests;
+        LONGLONG WriteUsingTokenBytes;
+        LONGLONG WriteUsingTokenTime;
+    } OffloadStatistics;
+
 };
 
 //
@@ -1078,6 +1232,8 @@ typedef struct _OFFLOAD_READ_CONTEXT {
 
     SCSI_REQUEST_BLOCK Srb;
 
+    ULONGLONG OperationStartTime;
+
     //
     // Pointer into the token part of the SCSI buffer (the buffer immediately
     // after this struct), for easy reference.
@@ -1091,6 +1247,13 @@ typedef struct _OFFLOAD_READ_CONTEXT {
 } OFFLOAD_READ_CONTEXT, *POFFLOAD_READ_CONTEXT;
 
 
+typedef struct _OFFLOAD_WRITE_SLICE {
+    ULONGLONG SectorsRequested;
+    ULONGLONG SectorsWritten;
+    NTSTATUS Status;
+    BOOLEAN Done;
+} OFFLOAD_WRITE_SLICE, *POFFLOAD_WRITE_SLICE;
+
 typedef struct _OFFLOAD_WRITE_CONTEXT {
 
     PDEVICE_OBJECT Fdo;
@@ -1142,6 +1305,29 @@ typedef struct _OFFLOAD_WRITE_CONTEXT {
 
     ULONGLONG OperationStartTime;
 
+    //
+    // Pipelined offload write only (see ClasspStartOffloadWriteSlices).
+    //
+    // The overall request is carved into slices of at most one WRITE USING
+    // TOKEN worth of sectors.  Each slice is written by a child context
+    // running the same state machine as a non-pipelined offload write, and
+    // the parent context completes the upper irp once they are all done.
+    //
+
+    struct _OFFLOAD_WRITE_CONTEXT *Parent;      // Child: the parent context
+    ULONG SliceIndex;                           // Child: slice it is writing
+
+    KSPIN_LOCK PipelineLock;                    // Parent: protects the fields below
+    ULONG PipelineDepth;
+    ULONG NextSliceIndex;
+    ULONG FirstPendingSliceIndex;
+    ULONG PipelineReferences;                   // Slices in flight, plus callers of ClasspStartOffloadWriteSlices
+    ULONGLONG SectorsSliced;
+    BOOLEAN PipelineStopped;                    // Don't start any more slices
+    BOOLEAN PipelineTruncated;                  // Don't count any more slices
+    NTSTATUS PipelineStatus;
+    OFFLOAD_WRITE_SLICE Slices[MAX_OFFLOAD_WRITE_PIPELINE_DEPTH];
+
 } OFFLOAD_WRITE_CONTEXT, *POFFLOAD_WRITE_CONTEXT;
 
 
@@ -1179,6 +1365,8 @@ typedef struct _IO_RETRIED_LOG_MESSAGE_CONTEXT {
 #define CLASS_IDLE_INTERVAL         50          // 50 milliseconds
 #define CLASS_STARVATION_INTERVAL   500         // 500 milliseconds
 #define CLASS_IDLE_TIMER_TICKS      4
+#define CLASS_IDLE_BURST_SIZE       1024        // 1 megabyte, in KB
+#define CLASS_IDLE_MAX_BANDWIDTH    (1024 * 1024) // 1 gigabyte per second, in KB
 
 //
 // Value of 50 milliseconds in 100 nanoseconds units
@@ -1720,6 +1908,11 @@ VOID DestroyAllTransferPackets(PDEVICE_OBJECT Fdo);
 VOID InterpretCapacityData(PDEVICE_OBJECT Fdo, PREAD_CAPACITY_DATA_EX ReadCapacityData);
 IO_WORKITEM_ROUTINE_EX CleanupTransferPacketToWorkingSetSizeWorker;
 VOID CleanupTransferPacketToWorkingSetSize(_In_ PDEVICE_OBJECT Fdo, _In_ BOOLEAN LimitNumPktToDelete, _In_ ULONG Node);
+BOOLEAN ClasspCoalesceTransferRequest(_In_ PDEVICE_OBJECT Fdo, _In_ PIRP Irp);
+VOID ClasspFlushCoalescedTransferRequests(_In_ PDEVICE_OBJECT Fdo, _In_ BOOLEAN PostToDpc);
+KDEFERRED_ROUTINE ClasspCoalesceTimerDpc;
+DRIVER_CANCEL ClasspCoalesceCancelRoutine;
+IO_COMPLETION_ROUTINE ClasspCoalescedTransferComplete;
 
 _IRQL_requires_max_(APC_LEVEL)
 _IRQL_requires_min_(PASSIVE_LEVEL)
@@ -2210,6 +2403,20 @@ ClasspReceiveWriteUsingTokenInformationTransferPacketDone(
     _In_ POFFLOAD_WRITE_CONTEXT OffloadWriteContext
     );
 
+VOID
+ClasspStartOffloadWriteSlices(
+    _In_ POFFLOAD_WRITE_CONTEXT OffloadWriteContext
+    );
+
+VOID
+ClasspOffloadWriteSliceDone(
+    _In_ POFFLOAD_WRITE_CONTEXT OffloadWriteContext,
+    _In_ ULONG SliceIndex,
+    _In_ ULONGLONG SectorsWritten,
+    _In_ BOOLEAN TokenInvalidated,
+    _In_ NTSTATUS CompletionCausingStatus
+    );
+
 NTSTATUS
 ClasspRefreshFunctionSupportInfo(
     _Inout_ PFUNCTIONAL_DEVICE_EXTENSION FdoExtension,
@@ -2283,6 +2490,12 @@ ClasspCompleteIdleRequest(
     PFUNCTIONAL_DEVICE_EXTENSION FdoExtension
     );
 
+VOID
+ClasspIdleRecordForegroundLatency(
+    PCLASS_PRIVATE_FDO_DATA FdoData,
+    ULONGLONG RequestStartTime
+    );
+
 NTSTATUS
 ClasspPriorityHint(
     PDEVICE_OBJECT DeviceObject,
@@ -2328,6 +2541,45 @@ HistoryLogReturnedPacket(
         }                                      \
     }
 
+VOID
+HistoryInitializeLatencyHistograms(
+    PDEVICE_OBJECT Fdo
+    );
+
+VOID
+HistoryFreeLatencyHistograms(
+    PDEVICE_OBJECT Fdo
+    );
+
+VOID
+HistoryLogPacketLatency(
+    TRANSFER_PACKET *Pkt
+    );
+
+#define HISTORYLOGPACKETLATENCY(_packet, _fdoData)     \
+    {                                                  \
+        if (_fdoData->LatencyHistograms != NULL) {     \
+            HistoryLogPacketLatency(_packet);          \
+        }                                              \
+    }
+
+VOID
+HistoryQueryLatencyHistogram(
+    _In_ PCLASS_PRIVATE_FDO_DATA FdoData,
+    _Out_writes_(CLASS_LATENCY_HISTOGRAM_BUCKETS) PLONGLONG ReadBuckets,
+    _Out_writes_(CLASS_LATENCY_HISTOGRAM_BUCKETS) PLONGLONG WriteBuckets
+    );
+
+ULONGLONG
+HistoryGetLatencyPercentile(
+    _In_reads_(CLASS_LATENCY_HISTOGRAM_BUCKETS) PLONGLONG Buckets,
+    _In_ ULONG PerMille
+    );
+
+ETWENABLECALLBACK HistoryLatencyEtwCallback;
+
+extern GUID ClassLatencyHistogramGuid;
+
 BOOLEAN
 InterpretSenseInfoWithoutHistory(
     _In_  PDEVICE_OBJECT Fdo,
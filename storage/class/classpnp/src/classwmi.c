@@ -99,11 +99,23 @@ GUIDREGINFO wmiClassGuids[] =
     },
     {
         MSStorageDriver_ClassErrorLogGuid, 1, 0
+    },
+    {
+        MSStorageDriver_ClassTransferPacketStatisticsGuid, 1, 0
+    },
+    {
+        MSStorageDriver_ClassLatencyHistogramGuid, 1, 0
+    },
+    {
+        MSStorageDriver_ClassOffloadStatisticsGuid, 1, 0
     }
 };
 
 #define MSWmi_MofData_GUID_Index                    0
 #define MSStorageDriver_ClassErrorLogGuid_Index     1
+#define MSStorageDriver_ClassTransferPacketStatisticsGuid_Index 2
+#define MSStorageDriver_ClassLatencyHistogramGuid_Index 3
+#define MSStorageDriver_ClassOffloadStatisticsGuid_Index 4
 #define NUM_CLASS_WMI_GUIDS     (sizeof(wmiClassGuids) / sizeof(GUIDREGINFO))
 
 
@@ -913,6 +925,114 @@ Return Value:
         } else {
             status = STATUS_BUFFER_TOO_SMALL;
         }
+    } else if (GuidIndex == MSStorageDriver_ClassTransferPacketStatisticsGuid_Index) {
+
+        //
+        // Sum up the per-node pool counters and the per-processor hit/miss
+        // counters of the transfer packet pool. They are sampled without a
+        // lock, so the totals are only approximately consistent.
+        //
+        PCLASS_PRIVATE_FDO_DATA fdoData = fdoExt->PrivateFdoData;
+
+        sizeNeeded = MSStorageDriver_ClassTransferPacketStatistics_SIZE;
+        if (!fdoExt->CommonExtension.IsFdo ||
+            fdoData == NULL ||
+            fdoData->FreeTransferPacketsLists == NULL) {
+            status = STATUS_WMI_INSTANCE_NOT_FOUND;
+        } else if (BufferAvail >= sizeNeeded) {
+            PMSStorageDriver_ClassTransferPacketStatistics pktStats = (PMSStorageDriver_ClassTransferPacketStatistics) Buffer;
+            PPNL_SLIST_HEADER freeList;
+            PTRANSFER_PACKET_CACHE cache;
+            ULONG nodeCount = KeQueryHighestNodeNumber() + 1;
+
+            RtlZeroMemory(pktStats, sizeNeeded);
+
+            for (i = 0; i < nodeCount; i++) {
+                freeList = &fdoData->FreeTransferPacketsLists[i];
+                pktStats->totalTransferPackets += freeList->NumTotalTransferPackets;
+                pktStats->freeTransferPackets += freeList->NumFreeTransferPackets;
+                pktStats->maxWorkingSetTransferPackets += freeList->MaxWorkingSetTransferPackets;
+                pktStats->outstandingHighWater += max(freeList->OutstandingHighWater,
+                                                      freeList->PreviousOutstandingHighWater);
+            }
+
+            for (i = 0; i < fdoData->TransferPacketCacheCount; i++) {
+                cache = &fdoData->TransferPacketCaches[i];
+                pktStats->cacheHits += cache->CacheHits;
+                pktStats->freeListHits += cache->FreeListHits;
+                pktStats->misses += cache->Misses;
+                pktStats->allocationFailures += cache->AllocationFailures;
+            }
+            status = STATUS_SUCCESS;
+        } else {
+            status = STATUS_BUFFER_TOO_SMALL;
+        }
+    } else if (GuidIndex == MSStorageDriver_ClassLatencyHistogramGuid_Index) {
+
+        PCLASS_PRIVATE_FDO_DATA fdoData = fdoExt->PrivateFdoData;
+
+        C_ASSERT(RTL_NUMBER_OF(((PMSStorageDriver_ClassLatencyHistogram)0)->readBuckets) == CLASS_LATENCY_HISTOGRAM_BUCKETS);
+
+        sizeNeeded = MSStorageDriver_ClassLatencyHistogram_SIZE;
+        if (!fdoExt->CommonExtension.IsFdo ||
+            fdoData == NULL ||
+            fdoData->LatencyHistograms == NULL) {
+            status = STATUS_WMI_INSTANCE_NOT_FOUND;
+        } else if (BufferAvail >= sizeNeeded) {
+            PMSStorageDriver_ClassLatencyHistogram histogram = (PMSStorageDriver_ClassLatencyHistogram) Buffer;
+
+            histogram->bucketCount = CLASS_LATENCY_HISTOGRAM_BUCKETS;
+            HistoryQueryLatencyHistogram(fdoData,
+                                         (PLONGLONG)histogram->readBuckets,
+                                         (PLONGLONG)histogram->writeBuckets);
+
+            histogram->readLatencyP50 = HistoryGetLatencyPercentile((PLONGLONG)histogram->readBuckets, 500);
+            histogram->readLatencyP99 = HistoryGetLatencyPercentile((PLONGLONG)histogram->readBuckets, 990);
+            histogram->readLatencyP999 = HistoryGetLatencyPercentile((PLONGLONG)histogram->readBuckets, 999);
+            histogram->writeLatencyP50 = HistoryGetLatencyPercentile((PLONGLONG)histogram->writeBuckets, 500);
+            histogram->writeLatencyP99 = HistoryGetLatencyPercentile((PLONGLONG)histogram->writeBuckets, 990);
+            histogram->writeLatencyP999 = HistoryGetLatencyPercentile((PLONGLONG)histogram->writeBuckets, 999);
+            status = STATUS_SUCCESS;
+        } else {
+            status = STATUS_BUFFER_TOO_SMALL;
+        }
+    } else if (GuidIndex == MSStorageDriver_ClassOffloadStatisticsGuid_Index) {
+
+        PCLASS_PRIVATE_FDO_DATA fdoData = fdoExt->PrivateFdoData;
+
+        sizeNeeded = MSStorageDriver_ClassOffloadStatistics_SIZE;
+        if (!fdoExt->CommonExtension.IsFdo ||
+            fdoData == NULL) {
+            status = STATUS_WMI_INSTANCE_NOT_FOUND;
+        } else if (BufferAvail >= sizeNeeded) {
+            PMSStorageDriver_ClassOffloadStatistics offloadStats = (PMSStorageDriver_ClassOffloadStatistics) Buffer;
+
+            RtlZeroMemory(offloadStats, sizeNeeded);
+
+            offloadStats->writePipelineDepth = max(fdoData->OffloadWritePipelineDepth, 1);
+            offloadStats->populateTokenRequests = fdoData->OffloadStatistics.PopulateTokenRequests;
+            offloadStats->populateTokenBytes = fdoData->OffloadStatistics.PopulateTokenBytes;
+            offloadStats->populateTokenTime = fdoData->OffloadStatistics.PopulateTokenTime;
+            offloadStats->writeUsingTokenRequests = fdoData->OffloadStatistics.WriteUsingTokenRequests;
+            offloadStats->writeUsingTokenBytes = fdoData->OffloadStatistics.WriteUsingTokenBytes;
+            offloadStats->writeUsingTokenTime = fdoData->OffloadStatistics.WriteUsingTokenTime;
+
+            //
+            // Time is in 100ns units.  Convert it to milliseconds first so
+            // that the byte counts can be scaled without overflowing.
+            //
+            if (offloadStats->populateTokenTime >= 10 * 1000) {
+                offloadStats->populateTokenThroughput =
+                    offloadStats->populateTokenBytes / (offloadStats->populateTokenTime / (10 * 1000)) * 1000;
+            }
+            if (offloadStats->writeUsingTokenTime >= 10 * 1000) {
+                offloadStats->writeUsingTokenThroughput =
+                    offloadStats->writeUsingTokenBytes / (offloadStats->writeUsingTokenTime / (10 * 1000)) * 1000;
+            }
+            status = STATUS_SUCCESS;
+        } else {
+            status = STATUS_BUFFER_TOO_SMALL;
+        }
     } else if (GuidIndex > 0 && GuidIndex < NUM_CLASS_WMI_GUIDS) {
         status = STATUS_WMI_INSTANCE_NOT_FOUND;
     } else {
@@ -50,7 +50,13 @@ ClasspServiceIdleRequest(
 
 PIRP
 ClasspDequeueIdleRequest(
-    PFUNCTIONAL_DEVICE_EXTENSION FdoExtension
+    PFUNCTIONAL_DEVICE_EXTENSION FdoExtension,
+    BOOLEAN ExpiredOnly
+    );
+
+LOGICAL
+ClasspIdleBandwidthAvailable (
+    IN PCLASS_PRIVATE_FDO_DATA FdoData
     );
 
 
@@ -181,6 +187,10 @@ ClasspInitializeIdleTimer(
     ULONG idleInterval = CLASS_IDLE_INTERVAL;
     ULONG idlePrioritySupported = TRUE;
     ULONG activeIdleIoMax = 1;
+    ULONG bandwidthLimit = 0;
+    ULONG burstSize = CLASS_IDLE_BURST_SIZE;
+    ULONG deadline = 0;
+    ULONG latencyTarget = 0;
 
     ClassGetDeviceParameter(FdoExtension,
                             CLASSP_REG_SUBKEY_NAME,
@@ -246,6 +256,50 @@ ClasspInitializeIdleTimer(
 
     fdoData->IdleActiveIoMax = (USHORT)activeIdleIoMax;
 
+    //
+    // Idle scheduler parameters.  All of them default to off, which leaves
+    // idle I/O governed by the idle interval alone.
+    //
+    ClassGetDeviceParameter(FdoExtension,
+                            CLASSP_REG_SUBKEY_NAME,
+                            CLASSP_REG_IDLE_BANDWIDTH_LIMIT,
+                            &bandwidthLimit);
+
+    ClassGetDeviceParameter(FdoExtension,
+                            CLASSP_REG_SUBKEY_NAME,
+                            CLASSP_REG_IDLE_BURST_SIZE,
+                            &burstSize);
+
+    ClassGetDeviceParameter(FdoExtension,
+                            CLASSP_REG_SUBKEY_NAME,
+                            CLASSP_REG_IDLE_DEADLINE,
+                            &deadline);
+
+    ClassGetDeviceParameter(FdoExtension,
+                            CLASSP_REG_SUBKEY_NAME,
+                            CLASSP_REG_IDLE_LATENCY_TARGET,
+                            &latencyTarget);
+
+    burstSize = max(burstSize, 1);
+    burstSize = min(burstSize, MAXULONG / 1024);
+
+    fdoData->IdleScheduler.BandwidthLimit = min(bandwidthLimit, CLASS_IDLE_MAX_BANDWIDTH);
+    fdoData->IdleScheduler.BucketSize = burstSize * 1024;
+    fdoData->IdleScheduler.Tokens = fdoData->IdleScheduler.BucketSize;
+    fdoData->IdleScheduler.LastRefillTime = KeQueryUnbiasedInterruptTime();
+    fdoData->IdleScheduler.LatencyTarget = latencyTarget;
+    fdoData->IdleScheduler.ForegroundLatency = 0;
+    fdoData->IdleScheduler.PromotedRequests = 0;
+
+    if (deadline != 0) {
+        //
+        // A deadline shorter than the starvation interval would defeat the
+        // idle interval altogether.
+        //
+        deadline = max(deadline, CLASS_STARVATION_INTERVAL);
+    }
+    fdoData->IdleScheduler.Deadline = deadline;
+
     return;
 }
 
@@ -473,6 +527,140 @@ ClasspIdleTicksSufficient (
 
 /*++
 
+ClasspIdleBandwidthAvailable
+
+Routine Description:
+
+    This routine refills the idle token bucket for the time that has passed
+    since the last refill and reports whether the bucket can pay for another
+    idle request. The bucket is allowed to go into debt by at most one request,
+    which is paid back before the next one is issued.
+
+Arguments:
+
+    FdoData - Pointer to the private fdo data
+
+Return Value:
+
+    TRUE if the idle bandwidth limit allows the next idle request to be issued.
+
+--*/
+LOGICAL
+ClasspIdleBandwidthAvailable (
+    IN PCLASS_PRIVATE_FDO_DATA FdoData
+    )
+{
+    ULONGLONG currentTime;
+    ULONGLONG elapsedMs;
+    LOGICAL available;
+    KIRQL oldIrql;
+
+    if (FdoData->IdleScheduler.BandwidthLimit == 0) {
+        return TRUE;
+    }
+
+    KeAcquireSpinLock(&FdoData->IdleListLock, &oldIrql);
+
+    currentTime = KeQueryUnbiasedInterruptTime();
+    elapsedMs = (currentTime - FdoData->IdleScheduler.LastRefillTime) / (10 * 1000);
+
+    if (elapsedMs > 0) {
+        //
+        // Only whole milliseconds are credited so that frequent callers don't
+        // lose the remainder.  BandwidthLimit is capped at CLASS_IDLE_MAX_BANDWIDTH
+        // so the product below cannot overflow.
+        //
+        FdoData->IdleScheduler.LastRefillTime += elapsedMs * 10 * 1000;
+        elapsedMs = min(elapsedMs, MAXULONG);
+
+        FdoData->IdleScheduler.Tokens +=
+            (LONGLONG)((elapsedMs * FdoData->IdleScheduler.BandwidthLimit * 1024) / 1000);
+        FdoData->IdleScheduler.Tokens =
+            min(FdoData->IdleScheduler.Tokens, (LONGLONG)FdoData->IdleScheduler.BucketSize);
+    }
+
+    available = (FdoData->IdleScheduler.Tokens > 0);
+
+    KeReleaseSpinLock(&FdoData->IdleListLock, oldIrql);
+
+    return available;
+}
+
+/*++
+
+ClasspIdleLatencyAcceptable
+
+Routine Description:
+
+    This routine checks the smoothed latency of recently completed non-idle
+    requests against the configured target.
+
+Arguments:
+
+    FdoData - Pointer to the private fdo data
+
+Return Value:
+
+    TRUE if foreground I/O is meeting its latency target.
+
+--*/
+__inline
+LOGICAL
+ClasspIdleLatencyAcceptable (
+    IN PCLASS_PRIVATE_FDO_DATA FdoData
+    )
+{
+    return ((FdoData->IdleScheduler.LatencyTarget == 0) ||
+            (FdoData->IdleScheduler.ForegroundLatency <= FdoData->IdleScheduler.LatencyTarget));
+}
+
+/*++
+
+ClasspIdleRecordForegroundLatency
+
+Routine Description:
+
+    This routine folds the latency of a completed non-idle transfer packet into
+    the moving average that the idle scheduler uses to back off while idle I/O
+    is hurting foreground I/O. Concurrent completions may race on the update;
+    losing an occasional sample is harmless for an average.
+
+Arguments:
+
+    FdoData          - Pointer to the private fdo data
+    RequestStartTime - Performance counter value when the packet was sent
+
+Return Value:
+
+    None
+
+--*/
+VOID
+ClasspIdleRecordForegroundLatency(
+    PCLASS_PRIVATE_FDO_DATA FdoData,
+    ULONGLONG RequestStartTime
+    )
+{
+    ULONGLONG latency;
+    ULONG average;
+
+    if (FdoData->IdleScheduler.LatencyTarget == 0) {
+        return;
+    }
+
+    latency = (ULONGLONG)KeQueryPerformanceCounter(NULL).QuadPart - RequestStartTime;
+    latency = (latency * 1000 * 1000) / FdoData->PerfCounterFrequency.QuadPart;
+    latency = min(latency, MAXULONG);
+
+    //
+    // Exponentially weighted moving average with a weight of 1/8.
+    //
+    average = FdoData->IdleScheduler.ForegroundLatency;
+    FdoData->IdleScheduler.ForegroundLatency = average - (average >> 3) + ((ULONG)latency >> 3);
+}
+
+/*++
+
 ClasspIdleTimerDpc
 
 Routine Description:
@@ -487,6 +675,10 @@ Routine Description:
     reaches the starvation idle count (1 second) it will process
     one idle request.
 
+    Before either of the above, an idle request that has been queued
+    past the idle deadline is promoted to normal priority and issued
+    regardless of foreground activity.
+
 Arguments:
 
     Dpc             - Pointer to DPC object
@@ -509,6 +701,7 @@ ClasspIdleTimerDpc(
 {
     PFUNCTIONAL_DEVICE_EXTENSION fdoExtension = Context;
     PCLASS_PRIVATE_FDO_DATA fdoData;
+    PIRP irp;
 
     UNREFERENCED_PARAMETER(Dpc);
     UNREFERENCED_PARAMETER(SystemArgument1);
@@ -521,6 +714,31 @@ ClasspIdleTimerDpc(
 
     fdoData = fdoExtension->PrivateFdoData;
 
+    if (fdoData->IdleScheduler.Deadline != 0) {
+        irp = ClasspDequeueIdleRequest(fdoExtension, TRUE);
+        if (irp != NULL) {
+            //
+            // The request has waited long enough; send it as a normal priority
+            // request so it is no longer held back by foreground I/O.
+            //
+            TracePrint((TRACE_LEVEL_INFORMATION, TRACE_FLAG_TIMER, "ClasspIdleTimerDpc: Promote expired idle request %p\n", irp));
+            fdoData->IdleScheduler.PromotedRequests++;
+            fdoData->IdleTimerTicks = 0;
+            ClasspMarkIrpAsIdle(irp, FALSE);
+            ServiceTransferRequest(fdoExtension->DeviceObject, irp, FALSE);
+            return;
+        }
+    }
+
+    if (fdoData->ActiveIoCount <= 0) {
+        //
+        // Foreground I/O has drained, so let the latency average decay
+        // towards zero; otherwise one slow burst would hold idle I/O off
+        // until the deadline.
+        //
+        fdoData->IdleScheduler.ForegroundLatency -= (fdoData->IdleScheduler.ForegroundLatency >> 3);
+    }
+
     if ((fdoData->ActiveIoCount <= 0) &&
         (++fdoData->IdleTicks >= CLASS_IDLE_TIMER_TICKS)) {
 
@@ -533,10 +751,12 @@ ClasspIdleTimerDpc(
 
         //
         // Check whether enough idle time has passed since the last non-idle
-        // request has completed.
+        // request has completed, and whether the idle scheduler allows it.
         //
 
-        if (ClasspIdleTicksSufficient(fdoData)) {
+        if (ClasspIdleTicksSufficient(fdoData) &&
+            ClasspIdleLatencyAcceptable(fdoData) &&
+            ClasspIdleBandwidthAvailable(fdoData)) {
             //
             // We are going to issue an idle request so reset the anti-starvation
             // timer counter.
@@ -550,7 +770,10 @@ ClasspIdleTimerDpc(
     //
     // If the timer is running then there must be at least one idle priority I/O pending
     //
-    if (++fdoData->IdleTimerTicks >= fdoData->StarvationCount) {
+    // The anti-starvation request still honors the idle bandwidth limit.
+    //
+    if ((++fdoData->IdleTimerTicks >= fdoData->StarvationCount) &&
+        ClasspIdleBandwidthAvailable(fdoData)) {
         fdoData->IdleTimerTicks = 0;
         TracePrint((TRACE_LEVEL_INFORMATION, TRACE_FLAG_TIMER, "ClasspIdleTimerDpc: Starvation timer. Send one idle request\n"));
         ClasspServiceIdleRequest(fdoExtension, FALSE);
@@ -617,6 +840,18 @@ ClasspEnqueueIdleRequest(
         issueRequest = FALSE;
     }
 
+    if (issueRequest &&
+        (!ClasspIdleLatencyAcceptable(fdoData) ||
+         !ClasspIdleBandwidthAvailable(fdoData))) {
+        issueRequest = FALSE;
+    }
+
+    //
+    // Remember when the request was queued, in milliseconds, for the idle
+    // deadline.  DriverContext[2] is not used until the request is serviced.
+    //
+    Irp->Tail.Overlay.DriverContext[2] = ULongToPtr((ULONG)(KeQueryUnbiasedInterruptTime() / (10 * 1000)));
+
     TracePrint((TRACE_LEVEL_VERBOSE, TRACE_FLAG_TIMER, "ClasspEnqueueIdleRequest: Diff time %I64d\n", idleInterval));
 
     KeAcquireSpinLock(&fdoData->IdleListLock, &oldIrql);
@@ -653,10 +888,13 @@ Routine Description:
 
     This function will remove the next idle request from the list.
     If there are no requests in the queue, then it will return NULL.
+    The request's transfer length is charged to the idle token bucket.
 
 Arguments:
 
     FdoExtension         - Pointer to the functional device extension
+    ExpiredOnly          - Only remove the next request if it has been queued
+                           for longer than the idle deadline
 
 Return Value:
 
@@ -665,17 +903,32 @@ Return Value:
 --*/
 PIRP
 ClasspDequeueIdleRequest(
-    PFUNCTIONAL_DEVICE_EXTENSION FdoExtension
+    PFUNCTIONAL_DEVICE_EXTENSION FdoExtension,
+    BOOLEAN ExpiredOnly
     )
 {
     PCLASS_PRIVATE_FDO_DATA fdoData = FdoExtension->PrivateFdoData;
     PLIST_ENTRY listEntry = NULL;
     PIRP irp = NULL;
     KIRQL oldIrql;
+    BOOLEAN dequeue;
 
     KeAcquireSpinLock(&fdoData->IdleListLock, &oldIrql);
 
-    if (fdoData->IdleIoCount > 0) {
+    dequeue = (fdoData->IdleIoCount > 0);
+
+    if (dequeue && ExpiredOnly) {
+        ULONG currentTime = (ULONG)(KeQueryUnbiasedInterruptTime() / (10 * 1000));
+
+        //
+        // The list is in arrival order, so only the head can have expired first.
+        //
+        irp = CONTAINING_RECORD(fdoData->IdleIrpList.Flink, IRP, Tail.Overlay.ListEntry);
+        dequeue = ((currentTime - PtrToUlong(irp->Tail.Overlay.DriverContext[2])) >= fdoData->IdleScheduler.Deadline);
+        irp = NULL;
+    }
+
+    if (dequeue) {
         listEntry = RemoveHeadList(&fdoData->IdleIrpList);
         //
         // Make sure we actaully removed a request from the list
@@ -696,6 +949,11 @@ ClasspDequeueIdleRequest(
 
 
         InitializeListHead(&irp->Tail.Overlay.ListEntry);
+        irp->Tail.Overlay.DriverContext[2] = NULL;
+
+        if (fdoData->IdleScheduler.BandwidthLimit != 0) {
+            fdoData->IdleScheduler.Tokens -= IoGetCurrentIrpStackLocation(irp)->Parameters.Read.Length;
+        }
     }
 
     KeReleaseSpinLock(&fdoData->IdleListLock, oldIrql);
@@ -730,13 +988,16 @@ ClasspCompleteIdleRequest(
     //
     // Issue the next idle request if there are any left in the queue, there are
     // no non-idle requests outstanding, there are less than max idle requests
-    // outstanding, and it has been long enough since the completion of the last
-    // non-idle request.
+    // outstanding, it has been long enough since the completion of the last
+    // non-idle request, and the idle scheduler's latency and bandwidth limits
+    // allow it.
     //
     if ((fdoData->IdleIoCount > 0) &&
         (fdoData->ActiveIdleIoCount < fdoData->IdleActiveIoMax) &&
         (fdoData->ActiveIoCount <= 0) &&
-        (ClasspIdleTicksSufficient(fdoData))) {
+        (ClasspIdleTicksSufficient(fdoData)) &&
+        (ClasspIdleLatencyAcceptable(fdoData)) &&
+        (ClasspIdleBandwidthAvailable(fdoData))) {
         TracePrint((TRACE_LEVEL_INFORMATION, TRACE_FLAG_TIMER, "ClasspCompleteIdleRequest: Service next idle reqeusts\n"));
         ClasspServiceIdleRequest(FdoExtension, TRUE);
     }
@@ -772,7 +1033,7 @@ ClasspServiceIdleRequest(
 {
     PIRP irp;
 
-    irp = ClasspDequeueIdleRequest(FdoExtension);
+    irp = ClasspDequeueIdleRequest(FdoExtension, FALSE);
     if (irp != NULL) {
         ServiceTransferRequest(FdoExtension->DeviceObject, irp, PostToDpc);
     }
@@ -19,6 +19,17 @@ Notes:
 
     This module generates a static library
 
+    The dictionary is a hash table of singly linked buckets.  The table is
+    allocated when the first entry is added, doubles in size as entries are
+    added, and is freed again with the last entry.
+
+    The DICTIONARY structure itself is embedded in the public device
+    extension, so its layout cannot change: its List field holds the
+    table, and its SpinLock field holds an EX_SPIN_LOCK.  Lookups, inserts
+    and removals hold that lock shared and only lock the bucket they
+    touch; the lock is held exclusive only to create, grow or free the
+    table.
+
 Revision History:
 
 --*/
@@ -28,6 +39,15 @@ Revision History:
 
 #define DICTIONARY_SIGNATURE 'tciD'
 
+//
+// The table starts with 16 buckets and grows up to 4096 buckets, doubling
+// whenever it holds more than two entries per bucket.
+//
+
+#define DICTIONARY_INITIAL_BUCKET_SHIFT 4
+#define DICTIONARY_MAXIMUM_BUCKET_SHIFT 12
+#define DICTIONARY_LOAD_FACTOR          2
+
 #pragma warning(push)
 #pragma warning(disable:4200) // nonstandard extension used : zero-sized array in struct/union
 struct _DICTIONARY_HEADER {
@@ -40,7 +60,276 @@ struct _DICTIONARY_HEADER {
 struct _DICTIONARY_HEADER;
 typedef struct _DICTIONARY_HEADER DICTIONARY_HEADER, *PDICTIONARY_HEADER;
 
-
+typedef struct _DICTIONARY_BUCKET {
+    KSPIN_LOCK SpinLock;
+    PDICTIONARY_HEADER List;
+} DICTIONARY_BUCKET, *PDICTIONARY_BUCKET;
+
+#pragma warning(push)
+#pragma warning(disable:4200) // nonstandard extension used : zero-sized array in struct/union
+typedef struct _DICTIONARY_TABLE {
+    ULONG BucketShift;
+    volatile LONG EntryCount;
+    DICTIONARY_BUCKET Buckets[0];
+} DICTIONARY_TABLE, *PDICTIONARY_TABLE;
+#pragma warning(pop)
+
+C_ASSERT(sizeof(KSPIN_LOCK) >= sizeof(EX_SPIN_LOCK));
+
+#define DICTIONARY_LOCK(Dictionary) ((PEX_SPIN_LOCK) &((Dictionary)->SpinLock))
+#define DICTIONARY_TABLE_OF(Dictionary) ((PDICTIONARY_TABLE) (Dictionary)->List)
+
+
+__inline
+ULONG
+DictionaryHash(
+    IN ULONGLONG Key,
+    IN ULONG BucketShift
+    )
+{
+    //
+    // Keys are usually pointers, whose low bits carry no information.
+    // Multiplicative hashing takes the bucket index from the high bits.
+    //
+
+    return (ULONG) ((Key * 0x9E3779B97F4A7C15ULL) >> (64 - BucketShift));
+}
+
+
+__inline
+BOOLEAN
+DictionaryTableIsFull(
+    IN PDICTIONARY_TABLE Table
+    )
+{
+    return (Table->BucketShift < DICTIONARY_MAXIMUM_BUCKET_SHIFT) &&
+           ((ULONG) Table->EntryCount >= (DICTIONARY_LOAD_FACTOR << Table->BucketShift));
+}
+
+
+PDICTIONARY_TABLE
+DictionaryAllocateTable(
+    IN ULONG BucketShift
+    )
+{
+    PDICTIONARY_TABLE table;
+    ULONG bucketCount = 1UL << BucketShift;
+    ULONG i;
+
+    table = ExAllocatePoolWithTag(NonPagedPoolNx,
+                                  FIELD_OFFSET(DICTIONARY_TABLE, Buckets) +
+                                    (bucketCount * sizeof(DICTIONARY_BUCKET)),
+                                  DICTIONARY_SIGNATURE);
+
+    if (table == NULL) {
+        return NULL;
+    }
+
+    table->BucketShift = BucketShift;
+    table->EntryCount = 0;
+
+    for (i = 0; i < bucketCount; i++) {
+        KeInitializeSpinLock(&(table->Buckets[i].SpinLock));
+        table->Buckets[i].List = NULL;
+    }
+
+    return table;
+}
+
+
+VOID
+DictionaryMoveEntries(
+    IN PDICTIONARY_TABLE OldTable,
+    IN PDICTIONARY_TABLE NewTable
+    )
+/*++
+
+Routine Description:
+
+    Rehashes every entry of OldTable into NewTable.  The caller holds the
+    dictionary lock exclusive, so the buckets are not locked.
+
+--*/
+{
+    ULONG bucketCount = 1UL << OldTable->BucketShift;
+    ULONG i;
+
+    for (i = 0; i < bucketCount; i++) {
+
+        PDICTIONARY_HEADER entry = OldTable->Buckets[i].List;
+
+        while (entry != NULL) {
+
+            PDICTIONARY_HEADER next = entry->Next;
+            PDICTIONARY_BUCKET bucket =
+                &(NewTable->Buckets[DictionaryHash(entry->Key, NewTable->BucketShift)]);
+
+            entry->Next = bucket->List;
+            bucket->List = entry;
+            entry = next;
+        }
+
+        OldTable->Buckets[i].List = NULL;
+    }
+
+    NewTable->EntryCount = OldTable->EntryCount;
+    OldTable->EntryCount = 0;
+
+    return;
+}
+
+
+NTSTATUS
+DictionaryReserveEntry(
+    IN PDICTIONARY Dictionary
+    )
+/*++
+
+Routine Description:
+
+    Counts one more entry against the dictionary's table, creating or
+    growing the table first if needed.  Once reserved, the table cannot be
+    freed until the reservation is released by DictionaryReleaseEntry.
+
+    The new table is allocated without holding the dictionary lock.  If
+    growing fails, the entry goes into the current, fuller table.
+
+--*/
+{
+    PDICTIONARY_TABLE table;
+    PDICTIONARY_TABLE newTable = NULL;
+    PDICTIONARY_TABLE oldTable = NULL;
+    BOOLEAN grow = TRUE;
+    BOOLEAN reserved = FALSE;
+    BOOLEAN haveTable;
+    ULONG bucketShift = 0;
+    KIRQL oldIrql;
+
+    while (!reserved) {
+
+        oldIrql = ExAcquireSpinLockShared(DICTIONARY_LOCK(Dictionary));
+
+        table = DICTIONARY_TABLE_OF(Dictionary);
+        haveTable = (table != NULL);
+
+        if (haveTable && (!grow || !DictionaryTableIsFull(table))) {
+            InterlockedIncrement(&(table->EntryCount));
+            reserved = TRUE;
+        } else {
+            bucketShift = haveTable ? (table->BucketShift + 1) :
+                                      DICTIONARY_INITIAL_BUCKET_SHIFT;
+        }
+
+        ExReleaseSpinLockShared(DICTIONARY_LOCK(Dictionary), oldIrql);
+
+        if (reserved) {
+            break;
+        }
+
+        if ((newTable == NULL) || (newTable->BucketShift != bucketShift)) {
+
+            FREE_POOL(newTable);
+            newTable = DictionaryAllocateTable(bucketShift);
+
+            if (newTable == NULL) {
+                if (!haveTable) {
+                    return STATUS_INSUFFICIENT_RESOURCES;
+                }
+                grow = FALSE;
+                continue;
+            }
+        }
+
+        //
+        // Install the new table unless another caller changed the table in
+        // the meantime, in which case start over.
+        //
+
+        oldIrql = ExAcquireSpinLockExclusive(DICTIONARY_LOCK(Dictionary));
+
+        table = DICTIONARY_TABLE_OF(Dictionary);
+
+        if (table == NULL) {
+            if (newTable->BucketShift == DICTIONARY_INITIAL_BUCKET_SHIFT) {
+                reserved = TRUE;
+            }
+        } else if ((newTable->BucketShift == table->BucketShift + 1) &&
+                   DictionaryTableIsFull(table)) {
+            DictionaryMoveEntries(table, newTable);
+            oldTable = table;
+            reserved = TRUE;
+        }
+
+        if (reserved) {
+            newTable->EntryCount++;
+            Dictionary->List = (PDICTIONARY_HEADER) newTable;
+            newTable = NULL;
+        }
+
+        ExReleaseSpinLockExclusive(DICTIONARY_LOCK(Dictionary), oldIrql);
+    }
+
+    FREE_POOL(oldTable);
+    FREE_POOL(newTable);
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+DictionaryReleaseEntry(
+    IN PDICTIONARY Dictionary
+    )
+/*++
+
+Routine Description:
+
+    Drops one entry (or reservation) from the dictionary's table, and frees
+    the table once it is empty.
+
+--*/
+{
+    PDICTIONARY_TABLE table;
+    PDICTIONARY_TABLE emptyTable = NULL;
+    BOOLEAN empty = FALSE;
+    KIRQL oldIrql;
+
+    oldIrql = ExAcquireSpinLockShared(DICTIONARY_LOCK(Dictionary));
+
+    table = DICTIONARY_TABLE_OF(Dictionary);
+    NT_ASSERT(table != NULL);
+
+    if (table != NULL) {
+        empty = (InterlockedDecrement(&(table->EntryCount)) == 0);
+    }
+
+    ExReleaseSpinLockShared(DICTIONARY_LOCK(Dictionary), oldIrql);
+
+    if (empty) {
+
+        //
+        // Another entry may have been reserved since; only free the table if
+        // it is still empty.
+        //
+
+        oldIrql = ExAcquireSpinLockExclusive(DICTIONARY_LOCK(Dictionary));
+
+        table = DICTIONARY_TABLE_OF(Dictionary);
+
+        if ((table != NULL) && (table->EntryCount == 0)) {
+            Dictionary->List = NULL;
+            emptyTable = table;
+        }
+
+        ExReleaseSpinLockExclusive(DICTIONARY_LOCK(Dictionary), oldIrql);
+
+        FREE_POOL(emptyTable);
+    }
+
+    return;
+}
+
+
 VOID
 InitializeDictionary(
     IN PDICTIONARY Dictionary
@@ -48,11 +337,11 @@ InitializeDictionary(
 {
     RtlZeroMemory(Dictionary, sizeof(DICTIONARY));
     Dictionary->Signature = DICTIONARY_SIGNATURE;
-    KeInitializeSpinLock(&Dictionary->SpinLock);
+    *DICTIONARY_LOCK(Dictionary) = 0;
     return;
 }
 
-
+
 BOOLEAN
 TestDictionarySignature(
     IN PDICTIONARY Dictionary
@@ -71,8 +360,10 @@ AllocateDictionaryEntry(
     )
 {
     PDICTIONARY_HEADER header;
+    PDICTIONARY_TABLE table;
+    PDICTIONARY_BUCKET bucket;
     KIRQL oldIrql;
-    PDICTIONARY_HEADER *entry;
+    PDICTIONARY_HEADER entry;
 
     NTSTATUS status = STATUS_SUCCESS;
 
@@ -90,56 +381,59 @@ AllocateDictionaryEntry(
     header->Key = Key;
 
     //
-    // Find the correct location for this entry in the dictionary.
+    // Make sure there is a table with room for this entry.
     //
 
-    KeAcquireSpinLock(&(Dictionary->SpinLock), &oldIrql);
+    status = DictionaryReserveEntry(Dictionary);
+
+    if (!NT_SUCCESS(status)) {
+        FREE_POOL(header);
+        return status;
+    }
 
-    TRY {
+    //
+    // Insert the entry into its bucket.
+    //
 
-        entry = &(Dictionary->List);
+    oldIrql = ExAcquireSpinLockShared(DICTIONARY_LOCK(Dictionary));
 
-        while(*entry != NULL) {
-            if((*entry)->Key == Key) {
+    table = DICTIONARY_TABLE_OF(Dictionary);
+    bucket = &(table->Buckets[DictionaryHash(Key, table->BucketShift)]);
 
-                //
-                // Dictionary must have unique keys.
-                //
+    KeAcquireSpinLockAtDpcLevel(&(bucket->SpinLock));
 
-                status = STATUS_OBJECT_NAME_COLLISION;
-                LEAVE;
+    for (entry = bucket->List; entry != NULL; entry = entry->Next) {
+        if (entry->Key == Key) {
 
-            } else if ((*entry)->Key < Key) {
+            //
+            // Dictionary must have unique keys.
+            //
 
-                //
-                // We will go ahead and insert the key in here.
-                //
-                break;
-            } else {
-                entry = &((*entry)->Next);
-            }
+            status = STATUS_OBJECT_NAME_COLLISION;
+            break;
         }
+    }
 
-        //
-        // If we make it here then we will go ahead and do the insertion.
-        //
+    if (NT_SUCCESS(status)) {
+        header->Next = bucket->List;
+        bucket->List = header;
+    }
 
-        header->Next = *entry;
-        *entry = header;
+    KeReleaseSpinLockFromDpcLevel(&(bucket->SpinLock));
 
-    } FINALLY {
-        KeReleaseSpinLock(&(Dictionary->SpinLock), oldIrql);
+    ExReleaseSpinLockShared(DICTIONARY_LOCK(Dictionary), oldIrql);
 
-        if(!NT_SUCCESS(status)) {
-            FREE_POOL(header);
-        } else {
-            *Entry = (PVOID) header->Data;
-        }
+    if(!NT_SUCCESS(status)) {
+        DictionaryReleaseEntry(Dictionary);
+        FREE_POOL(header);
+    } else {
+        *Entry = (PVOID) header->Data;
     }
+
     return status;
 }
 
-
+
 PVOID
 GetDictionaryEntry(
     IN PDICTIONARY Dictionary,
@@ -147,31 +441,44 @@ GetDictionaryEntry(
     )
 {
     PDICTIONARY_HEADER entry;
+    PDICTIONARY_TABLE table;
+    PDICTIONARY_BUCKET bucket;
     PVOID data;
     KIRQL oldIrql;
 
 
     data = NULL;
 
-    KeAcquireSpinLock(&(Dictionary->SpinLock), &oldIrql);
+    oldIrql = ExAcquireSpinLockShared(DICTIONARY_LOCK(Dictionary));
 
-    entry = Dictionary->List;
-    while (entry != NULL) {
+    table = DICTIONARY_TABLE_OF(Dictionary);
 
-        if (entry->Key == Key) {
-            data = entry->Data;
-            break;
-        } else {
-            entry = entry->Next;
+    if (table != NULL) {
+
+        bucket = &(table->Buckets[DictionaryHash(Key, table->BucketShift)]);
+
+        KeAcquireSpinLockAtDpcLevel(&(bucket->SpinLock));
+
+        entry = bucket->List;
+        while (entry != NULL) {
+
+            if (entry->Key == Key) {
+                data = entry->Data;
+                break;
+            } else {
+                entry = entry->Next;
+            }
         }
+
+        KeReleaseSpinLockFromDpcLevel(&(bucket->SpinLock));
     }
 
-    KeReleaseSpinLock(&(Dictionary->SpinLock), oldIrql);
+    ExReleaseSpinLockShared(DICTIONARY_LOCK(Dictionary), oldIrql);
 
     return data;
 }
 
-
+
 VOID
 FreeDictionaryEntry(
     IN PDICTIONARY Dictionary,
@@ -180,27 +487,40 @@ FreeDictionaryEntry(
 {
     PDICTIONARY_HEADER header;
     PDICTIONARY_HEADER *entry;
+    PDICTIONARY_TABLE table;
+    PDICTIONARY_BUCKET bucket;
     KIRQL oldIrql;
     BOOLEAN found;
 
     found = FALSE;
     header = CONTAINING_RECORD(Entry, DICTIONARY_HEADER, Data);
 
-    KeAcquireSpinLock(&(Dictionary->SpinLock), &oldIrql);
+    oldIrql = ExAcquireSpinLockShared(DICTIONARY_LOCK(Dictionary));
 
-    entry = &(Dictionary->List);
-    while(*entry != NULL) {
+    table = DICTIONARY_TABLE_OF(Dictionary);
 
-        if(*entry == header) {
-            *entry = header->Next;
-            found = TRUE;
-            break;
-        } else {
-            entry = &(*entry)->Next;
+    if (table != NULL) {
+
+        bucket = &(table->Buckets[DictionaryHash(header->Key, table->BucketShift)]);
+
+        KeAcquireSpinLockAtDpcLevel(&(bucket->SpinLock));
+
+        entry = &(bucket->List);
+        while(*entry != NULL) {
+
+            if(*entry == header) {
+                *entry = header->Next;
+                found = TRUE;
+                break;
+            } else {
+                entry = &(*entry)->Next;
+            }
         }
+
+        KeReleaseSpinLockFromDpcLevel(&(bucket->SpinLock));
     }
 
-    KeReleaseSpinLock(&(Dictionary->SpinLock), oldIrql);
+    ExReleaseSpinLockShared(DICTIONARY_LOCK(Dictionary), oldIrql);
 
     //
     // calling this w/an invalid pointer invalidates the dictionary system,
@@ -209,6 +529,7 @@ FreeDictionaryEntry(
 
     NT_ASSERT(found);
     if (found) {
+        DictionaryReleaseEntry(Dictionary);
         FREE_POOL(header);
     }
 
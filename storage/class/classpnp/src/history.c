@@ -29,9 +29,11 @@ Revision History:
 #include "history.tmh"
 #endif
 
-//#ifdef ALLOC_PRAGMA
-//    #pragma alloc_text(PAGE, InitializeTransferPackets)
-//#endif
+#ifdef ALLOC_PRAGMA
+    #pragma alloc_text(PAGE, HistoryInitializeLatencyHistograms)
+    #pragma alloc_text(PAGE, HistoryFreeLatencyHistograms)
+    #pragma alloc_text(PAGE, HistoryLatencyEtwCallback)
+#endif
 
 VOID HistoryInitializeRetryLogs(_Out_ PSRB_HISTORY History, ULONG HistoryCount) {
     ULONG tmpSize = HistoryCount * sizeof(SRB_HISTORY_ITEM);
@@ -144,3 +146,278 @@ VOID HistoryLogReturnedPacket(TRANSFER_PACKET *Pkt) {
     return;
 }
 
+
+/*
+ *  HistoryInitializeLatencyHistograms
+ *
+ *      Allocate the per-processor read/write latency histograms of the
+ *      device and register the ETW provider that reports them.  The
+ *      histograms are optional; the device works without them.
+ */
+VOID HistoryInitializeLatencyHistograms(PDEVICE_OBJECT Fdo) {
+
+    PFUNCTIONAL_DEVICE_EXTENSION fdoExt = Fdo->DeviceExtension;
+    PCLASS_PRIVATE_FDO_DATA fdoData = fdoExt->PrivateFdoData;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    fdoData->LatencyHistogramCount = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    fdoData->LatencyHistograms =
+        ExAllocatePoolWithTag(NonPagedPoolNxCacheAligned,
+                              sizeof(CLASS_LATENCY_HISTOGRAM) * fdoData->LatencyHistogramCount,
+                              CLASS_TAG_PRIVATE_DATA);
+
+    if (fdoData->LatencyHistograms == NULL) {
+        TracePrint((TRACE_LEVEL_WARNING, TRACE_FLAG_INIT, "HistoryInitializeLatencyHistograms: Fdo %p, failed to allocate latency histograms.", Fdo));
+        fdoData->LatencyHistogramCount = 0;
+        return;
+    }
+
+    RtlZeroMemory(fdoData->LatencyHistograms,
+                  sizeof(CLASS_LATENCY_HISTOGRAM) * fdoData->LatencyHistogramCount);
+
+    //
+    // Each device registers its own instance of the provider, so that the
+    // rundown issued when a session enables it only has to look at this
+    // device and needs no synchronization with device removal.
+    //
+    status = EtwRegister(&ClassLatencyHistogramGuid,
+                         HistoryLatencyEtwCallback,
+                         Fdo,
+                         &fdoData->LatencyEtwHandle);
+    if (!NT_SUCCESS(status)) {
+        fdoData->LatencyEtwHandle = 0;
+    }
+
+    return;
+}
+
+
+VOID HistoryFreeLatencyHistograms(PDEVICE_OBJECT Fdo) {
+
+    PFUNCTIONAL_DEVICE_EXTENSION fdoExt = Fdo->DeviceExtension;
+    PCLASS_PRIVATE_FDO_DATA fdoData = fdoExt->PrivateFdoData;
+
+    PAGED_CODE();
+
+    //
+    // EtwUnregister waits for a running enable callback to return.
+    //
+    if (fdoData->LatencyEtwHandle != 0) {
+        EtwUnregister(fdoData->LatencyEtwHandle);
+        fdoData->LatencyEtwHandle = 0;
+    }
+
+    FREE_POOL(fdoData->LatencyHistograms);
+    fdoData->LatencyHistogramCount = 0;
+
+    return;
+}
+
+
+/*
+ *  HistoryLogPacketLatency
+ *
+ *      Add the time a read or write packet spent below us to the histogram
+ *      of the current processor.  Bucket N counts latencies from 2^N up to
+ *      2^(N+1) microseconds; the first and last buckets are open ended.
+ */
+VOID HistoryLogPacketLatency(TRANSFER_PACKET *Pkt) {
+
+    PFUNCTIONAL_DEVICE_EXTENSION fdoExt = Pkt->Fdo->DeviceExtension;
+    PCLASS_PRIVATE_FDO_DATA fdoData = fdoExt->PrivateFdoData;
+    PCLASS_LATENCY_HISTOGRAM histogram;
+    PLONGLONG buckets;
+    PCDB cdb;
+    BOOLEAN isWrite;
+    ULONG processor;
+    ULONGLONG latency;
+    CCHAR bucket;
+
+    cdb = SrbGetCdb(Pkt->Srb);
+    if (cdb == NULL) {
+        return;
+    }
+
+    switch (cdb->CDB10.OperationCode) {
+        case SCSIOP_READ:
+        case SCSIOP_READ16:
+            isWrite = FALSE;
+            break;
+        case SCSIOP_WRITE:
+        case SCSIOP_WRITE16:
+            isWrite = TRUE;
+            break;
+        default:
+            return;
+    }
+
+    processor = KeGetCurrentProcessorNumberEx(NULL);
+    if (processor >= fdoData->LatencyHistogramCount) {
+        return;
+    }
+
+    histogram = &fdoData->LatencyHistograms[processor];
+    buckets = isWrite ? histogram->WriteBuckets : histogram->ReadBuckets;
+
+    latency = (ULONGLONG)KeQueryPerformanceCounter(NULL).QuadPart - Pkt->RequestStartTime;
+    latency = (latency * 1000 * 1000) / fdoData->PerfCounterFrequency.QuadPart;
+
+    bucket = RtlFindMostSignificantBit(latency);
+    if (bucket < 0) {
+        bucket = 0;
+    } else if (bucket >= CLASS_LATENCY_HISTOGRAM_BUCKETS) {
+        bucket = CLASS_LATENCY_HISTOGRAM_BUCKETS - 1;
+    }
+
+    //
+    // Only threads running on this processor update this histogram, so
+    // the interlocked operation never has to fight for the cache line.
+    //
+    InterlockedIncrement64(&buckets[bucket]);
+
+    return;
+}
+
+
+/*
+ *  HistoryQueryLatencyHistogram
+ *
+ *      Merge the per-processor latency histograms of the device.
+ */
+VOID HistoryQueryLatencyHistogram(
+    _In_ PCLASS_PRIVATE_FDO_DATA FdoData,
+    _Out_writes_(CLASS_LATENCY_HISTOGRAM_BUCKETS) PLONGLONG ReadBuckets,
+    _Out_writes_(CLASS_LATENCY_HISTOGRAM_BUCKETS) PLONGLONG WriteBuckets
+    ) {
+
+    ULONG processor;
+    ULONG bucket;
+
+    RtlZeroMemory(ReadBuckets, sizeof(LONGLONG) * CLASS_LATENCY_HISTOGRAM_BUCKETS);
+    RtlZeroMemory(WriteBuckets, sizeof(LONGLONG) * CLASS_LATENCY_HISTOGRAM_BUCKETS);
+
+    for (processor = 0; processor < FdoData->LatencyHistogramCount; processor++) {
+        for (bucket = 0; bucket < CLASS_LATENCY_HISTOGRAM_BUCKETS; bucket++) {
+            ReadBuckets[bucket] += FdoData->LatencyHistograms[processor].ReadBuckets[bucket];
+            WriteBuckets[bucket] += FdoData->LatencyHistograms[processor].WriteBuckets[bucket];
+        }
+    }
+
+    return;
+}
+
+
+/*
+ *  HistoryGetLatencyPercentile
+ *
+ *      Return the upper bound, in microseconds, of the histogram bucket that
+ *      holds the given percentile (in tenths of a percent, so 999 is the
+ *      99.9th percentile), or 0 if the histogram is empty.
+ */
+ULONGLONG HistoryGetLatencyPercentile(
+    _In_reads_(CLASS_LATENCY_HISTOGRAM_BUCKETS) PLONGLONG Buckets,
+    _In_ ULONG PerMille
+    ) {
+
+    LONGLONG total = 0;
+    LONGLONG threshold;
+    LONGLONG count = 0;
+    ULONG bucket;
+
+    for (bucket = 0; bucket < CLASS_LATENCY_HISTOGRAM_BUCKETS; bucket++) {
+        total += Buckets[bucket];
+    }
+
+    if (total == 0) {
+        return 0;
+    }
+
+    threshold = (total * PerMille + 999) / 1000;
+
+    for (bucket = 0; bucket < CLASS_LATENCY_HISTOGRAM_BUCKETS - 1; bucket++) {
+        count += Buckets[bucket];
+        if (count >= threshold) {
+            break;
+        }
+    }
+
+    return 1ULL << (bucket + 1);
+}
+
+
+/*
+ *  HistoryLatencyEtwCallback
+ *
+ *      Write the merged latency histograms of the device as a rundown
+ *      event whenever a session enables the provider or captures its state.
+ */
+VOID NTAPI HistoryLatencyEtwCallback(
+    _In_ LPCGUID SourceId,
+    _In_ ULONG ControlCode,
+    _In_ UCHAR Level,
+    _In_ ULONGLONG MatchAnyKeyword,
+    _In_ ULONGLONG MatchAllKeyword,
+    _In_opt_ PEVENT_FILTER_DESCRIPTOR FilterData,
+    _Inout_opt_ PVOID CallbackContext
+    ) {
+
+    PDEVICE_OBJECT fdo = (PDEVICE_OBJECT)CallbackContext;
+    PFUNCTIONAL_DEVICE_EXTENSION fdoExt;
+    PCLASS_PRIVATE_FDO_DATA fdoData;
+    EVENT_DESCRIPTOR eventDescriptor;
+    EVENT_DATA_DESCRIPTOR eventData[4];
+    LONGLONG readBuckets[CLASS_LATENCY_HISTOGRAM_BUCKETS];
+    LONGLONG writeBuckets[CLASS_LATENCY_HISTOGRAM_BUCKETS];
+    ULONG bucketCount = CLASS_LATENCY_HISTOGRAM_BUCKETS;
+
+    UNREFERENCED_PARAMETER(SourceId);
+    UNREFERENCED_PARAMETER(Level);
+    UNREFERENCED_PARAMETER(MatchAnyKeyword);
+    UNREFERENCED_PARAMETER(MatchAllKeyword);
+    UNREFERENCED_PARAMETER(FilterData);
+
+    PAGED_CODE();
+
+    if ((fdo == NULL) ||
+        ((ControlCode != EVENT_CONTROL_CODE_ENABLE_PROVIDER) &&
+         (ControlCode != EVENT_CONTROL_CODE_CAPTURE_STATE))) {
+        return;
+    }
+
+    fdoExt = fdo->DeviceExtension;
+    fdoData = fdoExt->PrivateFdoData;
+
+    //
+    // The callback can run while EtwRegister is still returning the handle.
+    //
+    if (fdoData->LatencyEtwHandle == 0) {
+        return;
+    }
+
+    HistoryQueryLatencyHistogram(fdoData, readBuckets, writeBuckets);
+
+    EventDescCreate(&eventDescriptor,
+                    1,                          // Id
+                    0,                          // Version
+                    0,                          // Channel
+                    TRACE_LEVEL_INFORMATION,    // Level
+                    0,                          // Task
+                    3,                          // OpCode (EVENT_TRACE_TYPE_DC_START, rundown)
+                    0);                         // Keyword
+
+    EventDataDescCreate(&eventData[0], &fdo, sizeof(fdo));
+    EventDataDescCreate(&eventData[1], &bucketCount, sizeof(bucketCount));
+    EventDataDescCreate(&eventData[2], readBuckets, sizeof(readBuckets));
+    EventDataDescCreate(&eventData[3], writeBuckets, sizeof(writeBuckets));
+
+    EtwWrite(fdoData->LatencyEtwHandle,
+             &eventDescriptor,
+             NULL,
+             RTL_NUMBER_OF(eventData),
+             eventData);
+
+    return;
+}
+
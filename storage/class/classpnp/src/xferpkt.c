@@ -57,6 +57,7 @@ NTSTATUS InitializeTransferPackets(PDEVICE_OBJECT Fdo)
     ULONG maxOutstandingIOPerLUN;
     ULONG minWorkingSetTransferPackets;
     ULONG maxWorkingSetTransferPackets;
+    BOOLEAN adaptiveWorkingSet;
 
     NTSTATUS status = STATUS_SUCCESS;
 
@@ -90,8 +91,51 @@ NTSTATUS InitializeTransferPackets(PDEVICE_OBJECT Fdo)
         InitializeSListHead(&(fdoData->FreeTransferPacketsLists[index].SListHeader));
         fdoData->FreeTransferPacketsLists[index].NumTotalTransferPackets = 0;
         fdoData->FreeTransferPacketsLists[index].NumFreeTransferPackets = 0;
+        fdoData->FreeTransferPacketsLists[index].OutstandingHighWater = 0;
+        fdoData->FreeTransferPacketsLists[index].PreviousOutstandingHighWater = 0;
+        fdoData->FreeTransferPacketsLists[index].HighWaterPeriodStart = KeQueryInterruptTime();
     }
 
+    //
+    // Allocate the per-processor free packet caches. They are only an
+    // optimization, so carry on without them if the allocation fails.
+    //
+    fdoData->TransferPacketCacheCount = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    fdoData->TransferPacketCaches =
+        ExAllocatePoolWithTag(NonPagedPoolNxCacheAligned,
+                              sizeof(TRANSFER_PACKET_CACHE) * fdoData->TransferPacketCacheCount,
+                              CLASS_TAG_PRIVATE_DATA);
+
+    if (fdoData->TransferPacketCaches != NULL) {
+        RtlZeroMemory(fdoData->TransferPacketCaches,
+                      sizeof(TRANSFER_PACKET_CACHE) * fdoData->TransferPacketCacheCount);
+    } else {
+        TracePrint((TRACE_LEVEL_WARNING, TRACE_FLAG_INIT, "InitializeTransferPackets: failed to allocate per-processor packet caches."));
+        fdoData->TransferPacketCacheCount = 0;
+    }
+
+    HistoryInitializeLatencyHistograms(Fdo);
+
+    //
+    // Coalescing of adjacent reads/writes is off unless enabled in the
+    // registry.  A merged transfer goes through a bounce buffer, which buys
+    // nothing on a PIO adapter, and StartIo-serialized drivers may not take
+    // writes of arbitrary size, so it is never used for either.
+    //
+    KeInitializeSpinLock(&fdoData->Coalesce.Lock);
+    KeInitializeTimer(&fdoData->Coalesce.Timer);
+    KeInitializeDpc(&fdoData->Coalesce.Dpc, ClasspCoalesceTimerDpc, Fdo);
+    fdoData->Coalesce.Window = 0;
+    ClassGetDeviceParameter(fdoExt,
+                            CLASSP_REG_SUBKEY_NAME,
+                            CLASSP_REG_COALESCE_WINDOW,
+                            &fdoData->Coalesce.Window);
+    if (adapterDesc->AdapterUsesPio ||
+        (commonExt->DriverExtension->InitData.ClassStartIo != NULL)) {
+        fdoData->Coalesce.Window = 0;
+    }
+    fdoData->Coalesce.Window = MIN(fdoData->Coalesce.Window, COALESCE_MAX_WINDOW);
+
     InitializeListHead(&fdoData->AllTransferPacketsList);
 
     //
@@ -173,6 +217,7 @@ NTSTATUS InitializeTransferPackets(PDEVICE_OBJECT Fdo)
 
     fdoData->LocalMinWorkingSetTransferPackets = minWorkingSetTransferPackets;
     fdoData->LocalMaxWorkingSetTransferPackets = maxWorkingSetTransferPackets;
+    adaptiveWorkingSet = TRUE;
 
     //
     //  Allow class driver to override the settings
@@ -194,6 +239,8 @@ NTSTATUS InitializeTransferPackets(PDEVICE_OBJECT Fdo)
         if (workingSet->XferPacketsWorkingSetMaximum != 0)
         {
             fdoData->LocalMaxWorkingSetTransferPackets = workingSet->XferPacketsWorkingSetMaximum;
+            // an explicit maximum is honored as a hard limit
+            adaptiveWorkingSet = FALSE;
             // adjust minimum downwards if needed
             if (fdoData->LocalMinWorkingSetTransferPackets > fdoData->LocalMaxWorkingSetTransferPackets)
             {
@@ -203,7 +250,14 @@ NTSTATUS InitializeTransferPackets(PDEVICE_OBJECT Fdo)
         // that's all the adjustments required/allowed
     } // end working set size special code
 
+    fdoData->AdaptiveMaxWorkingSetTransferPackets = fdoData->LocalMaxWorkingSetTransferPackets;
+    if (adaptiveWorkingSet) {
+        fdoData->AdaptiveMaxWorkingSetTransferPackets *= MAX_ADAPTIVE_WORKINGSET_TRANSFER_PACKETS_FACTOR;
+    }
+
     for (index = 0; index < arraySize; index++) {
+        fdoData->FreeTransferPacketsLists[index].MinWorkingSetTransferPackets = fdoData->LocalMinWorkingSetTransferPackets;
+        fdoData->FreeTransferPacketsLists[index].MaxWorkingSetTransferPackets = fdoData->LocalMaxWorkingSetTransferPackets;
         while (fdoData->FreeTransferPacketsLists[index].NumFreeTransferPackets < MIN_INITIAL_TRANSFER_PACKETS){
             PTRANSFER_PACKET pkt = NewTransferPacket(Fdo);
             if (pkt) {
@@ -292,6 +346,7 @@ VOID DestroyAllTransferPackets(PDEVICE_OBJECT Fdo)
     TRANSFER_PACKET *pkt;
     ULONG index;
     ULONG arraySize;
+    ULONG slot;
 
     PAGED_CODE();
 
@@ -302,6 +357,26 @@ VOID DestroyAllTransferPackets(PDEVICE_OBJECT Fdo)
     if (fdoData->FreeTransferPacketsLists != NULL) {
 
         NT_ASSERT(IsListEmpty(&fdoData->DeferredClientIrpList));
+        NT_ASSERT(fdoData->Coalesce.FirstIrp == NULL);
+
+        //
+        // Make sure the coalescing timer DPC isn't still running.
+        //
+        KeCancelTimer(&fdoData->Coalesce.Timer);
+        KeFlushQueuedDpcs();
+
+        //
+        // Move the packets held in the per-processor caches back to the
+        // free list of their node. They are already counted as free.
+        //
+        for (index = 0; index < fdoData->TransferPacketCacheCount; index++) {
+            for (slot = 0; slot < TRANSFER_PACKET_CACHE_DEPTH; slot++) {
+                pkt = InterlockedExchangePointer((PVOID volatile *)&fdoData->TransferPacketCaches[index].Packets[slot], NULL);
+                if (pkt) {
+                    InterlockedPushEntrySList(&(fdoData->FreeTransferPacketsLists[pkt->AllocateNode].SListHeader), &pkt->SlistEntry);
+                }
+            }
+        }
 
         arraySize = KeQueryHighestNodeNumber() + 1;
         for (index = 0; index < arraySize; index++) {
@@ -316,6 +391,11 @@ VOID DestroyAllTransferPackets(PDEVICE_OBJECT Fdo)
         }
     }
 
+    FREE_POOL(fdoData->TransferPacketCaches);
+    fdoData->TransferPacketCacheCount = 0;
+
+    HistoryFreeLatencyHistograms(Fdo);
+
     FREE_POOL(fdoData->SrbTemplate);
 }
 
@@ -522,17 +602,74 @@ VOID DestroyTransferPacket(_In_ __drv_freesMem(mem) PTRANSFER_PACKET Pkt)
 }
 
 
+/*
+ *  AdaptTransferPacketWorkingSet
+ *
+ *      Recompute the working set of a node's packet pool from the peak
+ *      number of packets in use during the current and previous
+ *      TRANSFER_PACKET_HIGH_WATER_PERIOD.  Called whenever all of the node's
+ *      packets are free, right before deciding whether to free some.
+ *      Concurrent callers may race on the fields; they only steer trimming.
+ */
+static VOID AdaptTransferPacketWorkingSet(PCLASS_PRIVATE_FDO_DATA FdoData, ULONG Node)
+{
+    PPNL_SLIST_HEADER freeList = &FdoData->FreeTransferPacketsLists[Node];
+    ULONGLONG now = KeQueryInterruptTime();
+    ULONG highWater;
+
+    if (now - freeList->HighWaterPeriodStart >= TRANSFER_PACKET_HIGH_WATER_PERIOD) {
+        freeList->PreviousOutstandingHighWater = freeList->OutstandingHighWater;
+        freeList->OutstandingHighWater = 0;
+        freeList->HighWaterPeriodStart = now;
+    }
+
+    highWater = max(freeList->OutstandingHighWater, freeList->PreviousOutstandingHighWater);
+    highWater = min(highWater, FdoData->AdaptiveMaxWorkingSetTransferPackets);
+
+    freeList->MaxWorkingSetTransferPackets = max(FdoData->LocalMaxWorkingSetTransferPackets, highWater);
+    freeList->MinWorkingSetTransferPackets = max(FdoData->LocalMinWorkingSetTransferPackets, highWater);
+}
+
+
 VOID EnqueueFreeTransferPacket(PDEVICE_OBJECT Fdo, __drv_aliasesMem PTRANSFER_PACKET Pkt)
 {
     PFUNCTIONAL_DEVICE_EXTENSION fdoExt = Fdo->DeviceExtension;
     PCLASS_PRIVATE_FDO_DATA fdoData = fdoExt->PrivateFdoData;
     ULONG allocateNode;
+    ULONG processor;
+    ULONG slot;
+    BOOLEAN cached = FALSE;
     KIRQL oldIrql;
 
     NT_ASSERT(!Pkt->SlistEntry.Next);
 
     allocateNode = Pkt->AllocateNode;
-    InterlockedPushEntrySList(&(fdoData->FreeTransferPacketsLists[allocateNode].SListHeader), &Pkt->SlistEntry);
+
+    /*
+     *  Park the packet in this processor's cache if it belongs to this node
+     *  and the node isn't holding more packets than its working set (those
+     *  have to go back to the SLIST to be trimmed).
+     */
+    processor = KeGetCurrentProcessorNumberEx(NULL);
+    if ((processor < fdoData->TransferPacketCacheCount) &&
+        (allocateNode == KeGetCurrentNodeNumber()) &&
+        (fdoData->FreeTransferPacketsLists[allocateNode].NumTotalTransferPackets <=
+         fdoData->FreeTransferPacketsLists[allocateNode].MaxWorkingSetTransferPackets)) {
+
+        PTRANSFER_PACKET_CACHE cache = &fdoData->TransferPacketCaches[processor];
+
+        for (slot = 0; slot < TRANSFER_PACKET_CACHE_DEPTH; slot++) {
+            if ((cache->Packets[slot] == NULL) &&
+                (InterlockedCompareExchangePointer((PVOID volatile *)&cache->Packets[slot], Pkt, NULL) == NULL)) {
+                cached = TRUE;
+                break;
+            }
+        }
+    }
+
+    if (!cached) {
+        InterlockedPushEntrySList(&(fdoData->FreeTransferPacketsLists[allocateNode].SListHeader), &Pkt->SlistEntry);
+    }
     InterlockedIncrement((volatile LONG *)&(fdoData->FreeTransferPacketsLists[allocateNode].NumFreeTransferPackets));
 
     /*
@@ -549,11 +686,13 @@ VOID EnqueueFreeTransferPacket(PDEVICE_OBJECT Fdo, __drv_aliasesMem PTRANSFER_PA
     if (fdoData->FreeTransferPacketsLists[allocateNode].NumFreeTransferPackets >=
         fdoData->FreeTransferPacketsLists[allocateNode].NumTotalTransferPackets) {
 
+        AdaptTransferPacketWorkingSet(fdoData, allocateNode);
+
         /*
          *  1.  Immediately snap down to our UPPER threshold.
          */
         if (fdoData->FreeTransferPacketsLists[allocateNode].NumTotalTransferPackets >
-            fdoData->LocalMaxWorkingSetTransferPackets) {
+            fdoData->FreeTransferPacketsLists[allocateNode].MaxWorkingSetTransferPackets) {
 
             ULONG isRemoved;
             PIO_WORKITEM workItem = NULL;
@@ -603,7 +742,7 @@ VOID EnqueueFreeTransferPacket(PDEVICE_OBJECT Fdo, __drv_aliasesMem PTRANSFER_PA
          *  2.  Lazily work down to our LOWER threshold (by only freeing one packet at a time).
          */
         if (fdoData->FreeTransferPacketsLists[allocateNode].NumTotalTransferPackets >
-            fdoData->LocalMinWorkingSetTransferPackets){
+            fdoData->FreeTransferPacketsLists[allocateNode].MinWorkingSetTransferPackets){
             /*
              *  Check the counter again with lock held.  This eliminates a race condition
              *  while still allowing us to not grab the spinlock in the common codepath.
@@ -617,14 +756,14 @@ VOID EnqueueFreeTransferPacket(PDEVICE_OBJECT Fdo, __drv_aliasesMem PTRANSFER_PA
 
             TracePrint((TRACE_LEVEL_INFORMATION, TRACE_FLAG_RW, "Exiting stress, lazily freeing one of %d/%d packets from node %d.",
                 fdoData->FreeTransferPacketsLists[allocateNode].NumTotalTransferPackets,
-                fdoData->LocalMinWorkingSetTransferPackets,
+                fdoData->FreeTransferPacketsLists[allocateNode].MinWorkingSetTransferPackets,
                 allocateNode));
 
             KeAcquireSpinLock(&fdoData->SpinLock, &oldIrql);
             if ((fdoData->FreeTransferPacketsLists[allocateNode].NumFreeTransferPackets >=
                 fdoData->FreeTransferPacketsLists[allocateNode].NumTotalTransferPackets) &&
                 (fdoData->FreeTransferPacketsLists[allocateNode].NumTotalTransferPackets >
-                fdoData->LocalMinWorkingSetTransferPackets)){
+                fdoData->FreeTransferPacketsLists[allocateNode].MinWorkingSetTransferPackets)){
 
                 pktToDelete = DequeueFreeTransferPacketEx(Fdo, FALSE, allocateNode);
                 if (pktToDelete) {
@@ -632,7 +771,7 @@ VOID EnqueueFreeTransferPacket(PDEVICE_OBJECT Fdo, __drv_aliasesMem PTRANSFER_PA
                 } else {
                     TracePrint((TRACE_LEVEL_INFORMATION, TRACE_FLAG_RW,
                         "Extremely unlikely condition (non-fatal): %d packets dequeued at once for Fdo %p. NumTotalTransferPackets=%d (2). Node=%d",
-                        fdoData->LocalMinWorkingSetTransferPackets,
+                        fdoData->FreeTransferPacketsLists[allocateNode].MinWorkingSetTransferPackets,
                         Fdo,
                         fdoData->FreeTransferPacketsLists[allocateNode].NumTotalTransferPackets,
                         allocateNode));
@@ -661,14 +800,53 @@ PTRANSFER_PACKET DequeueFreeTransferPacketEx(
 {
     PFUNCTIONAL_DEVICE_EXTENSION fdoExt = Fdo->DeviceExtension;
     PCLASS_PRIVATE_FDO_DATA fdoData = fdoExt->PrivateFdoData;
-    PTRANSFER_PACKET pkt;
-    PSLIST_ENTRY slistEntry;
+    PTRANSFER_PACKET pkt = NULL;
+    PTRANSFER_PACKET_CACHE cache = NULL;
+    PSLIST_ENTRY slistEntry = NULL;
+    ULONG processor;
+    ULONG slot;
+    ULONG outstanding;
+
+    /*
+     *  Try this processor's cache first; it doesn't touch the shared SLIST.
+     *  The thread may have moved to another node since the packet was
+     *  cached, in which case it goes back to its own node's SLIST.
+     */
+    processor = KeGetCurrentProcessorNumberEx(NULL);
+    if (processor < fdoData->TransferPacketCacheCount) {
 
-    slistEntry = InterlockedPopEntrySList(&(fdoData->FreeTransferPacketsLists[Node].SListHeader));
+        cache = &fdoData->TransferPacketCaches[processor];
 
-    if (slistEntry) {
-        slistEntry->Next = NULL;
-        pkt = CONTAINING_RECORD(slistEntry, TRANSFER_PACKET, SlistEntry);
+        for (slot = 0; slot < TRANSFER_PACKET_CACHE_DEPTH; slot++) {
+            if (cache->Packets[slot] != NULL) {
+                pkt = InterlockedExchangePointer((PVOID volatile *)&cache->Packets[slot], NULL);
+                if (pkt) {
+                    if (pkt->AllocateNode == Node) {
+                        break;
+                    }
+                    InterlockedPushEntrySList(&(fdoData->FreeTransferPacketsLists[pkt->AllocateNode].SListHeader), &pkt->SlistEntry);
+                    pkt = NULL;
+                }
+            }
+        }
+    }
+
+    if (pkt) {
+        if (AllocIfNeeded) {
+            InterlockedIncrement64(&cache->CacheHits);
+        }
+    } else {
+        slistEntry = InterlockedPopEntrySList(&(fdoData->FreeTransferPacketsLists[Node].SListHeader));
+        if (slistEntry) {
+            slistEntry->Next = NULL;
+            pkt = CONTAINING_RECORD(slistEntry, TRANSFER_PACKET, SlistEntry);
+            if (AllocIfNeeded && cache) {
+                InterlockedIncrement64(&cache->FreeListHits);
+            }
+        }
+    }
+
+    if (pkt) {
         InterlockedDecrement((volatile LONG *)&(fdoData->FreeTransferPacketsLists[Node].NumFreeTransferPackets));
 
         // when dequeuing the packet, also reset the history data
@@ -682,6 +860,10 @@ PTRANSFER_PACKET DequeueFreeTransferPacketEx(
              *  allocate an extra packet.
              *  We will free it lazily when we are out of stress.
              */
+            if (cache) {
+                InterlockedIncrement64(&cache->Misses);
+            }
+
             pkt = NewTransferPacket(Fdo);
             if (pkt) {
                 InterlockedIncrement((volatile LONG *)&fdoData->FreeTransferPacketsLists[Node].NumTotalTransferPackets);
@@ -690,9 +872,22 @@ PTRANSFER_PACKET DequeueFreeTransferPacketEx(
                         fdoData->FreeTransferPacketsLists[Node].NumTotalTransferPackets);
             } else {
                 TracePrint((TRACE_LEVEL_WARNING, TRACE_FLAG_RW, "DequeueFreeTransferPacket: packet allocation failed"));
+                if (cache) {
+                    InterlockedIncrement64(&cache->AllocationFailures);
+                }
             }
-        } else {
-            pkt = NULL;
+        }
+    }
+
+    /*
+     *  Track how many packets the node needed at the same time, to size
+     *  its working set (see AdaptTransferPacketWorkingSet).
+     */
+    if (pkt && AllocIfNeeded) {
+        outstanding = fdoData->FreeTransferPacketsLists[Node].NumTotalTransferPackets -
+                      fdoData->FreeTransferPacketsLists[Node].NumFreeTransferPackets;
+        if ((LONG)outstanding > (LONG)fdoData->FreeTransferPacketsLists[Node].OutstandingHighWater) {
+            fdoData->FreeTransferPacketsLists[Node].OutstandingHighWater = outstanding;
         }
     }
 
@@ -914,6 +1109,12 @@ NTSTATUS SubmitTransferPacket(PTRANSFER_PACKET Pkt)
         }
     }
 
+    if (fdoData->Coalesce.Window != 0) {
+        InterlockedIncrement(&fdoData->Coalesce.OutstandingPackets);
+    }
+
+    Pkt->RequestStartTime = (ULONGLONG)KeQueryPerformanceCounter(NULL).QuadPart;
+
     IoSetCompletionRoutine(Pkt->Irp, TransferPktComplete, Pkt, TRUE, TRUE, TRUE);
     return IoCallDriver(nextDevObj, Pkt->Irp);
 }
@@ -936,7 +1137,11 @@ NTSTATUS TransferPktComplete(IN PDEVICE_OBJECT NullFdo, IN PIRP Irp, IN PVOID Co
     DBGLOGRETURNPACKET(pkt);
     DBGCHECKRETURNEDPKT(pkt);
     HISTORYLOGRETURNEDPACKET(pkt);
+    HISTORYLOGPACKETLATENCY(pkt, fdoData);
 
+    if (fdoData->Coalesce.Window != 0) {
+        InterlockedDecrement(&fdoData->Coalesce.OutstandingPackets);
+    }
 
     if (fdoData->IdlePrioritySupported == TRUE) {
         idleRequest = ClasspIsIdleRequest(pkt->OriginalIrp);
@@ -946,6 +1151,7 @@ NTSTATUS TransferPktComplete(IN PDEVICE_OBJECT NullFdo, IN PIRP Irp, IN PVOID Co
         } else {
             fdoData->LastIoTime = ClasspGetCurrentTime(NULL);
             fdoData->IdleTicks = 0;
+            ClasspIdleRecordForegroundLatency(fdoData, pkt->RequestStartTime);
             InterlockedDecrement(&fdoData->ActiveIoCount);
             NT_ASSERT(fdoData->ActiveIoCount >= 0);
         }
@@ -1264,6 +1470,12 @@ NTSTATUS TransferPktComplete(IN PDEVICE_OBJECT NullFdo, IN PIRP Irp, IN PVOID Co
             ServiceTransferRequest(Fdo, deferredIrp, TRUE);
         }
 
+        /*
+         *  Send down the client irps that were held back for coalescing
+         *  while this packet was outstanding.
+         */
+        ClasspFlushCoalescedTransferRequests(Fdo, TRUE);
+
         ClassReleaseRemoveLock(Fdo, (PVOID)&uniqueAddr);
     }
 
@@ -1271,6 +1483,507 @@ NTSTATUS TransferPktComplete(IN PDEVICE_OBJECT NullFdo, IN PIRP Irp, IN PVOID Co
 }
 
 
+/*
+ *  ClasspDetachCoalescedBatch
+ *
+ *      Take the batch of held-back client irps off the FDO.
+ *      Must be called with the coalescing lock held.
+ */
+static PIRP ClasspDetachCoalescedBatch(PCLASS_PRIVATE_FDO_DATA FdoData)
+{
+    PIRP firstIrp = FdoData->Coalesce.FirstIrp;
+
+    if (firstIrp != NULL) {
+        KeCancelTimer(&FdoData->Coalesce.Timer);
+        FdoData->Coalesce.FirstIrp = NULL;
+        FdoData->Coalesce.LastIrp = NULL;
+        FdoData->Coalesce.IrpCount = 0;
+        FdoData->Coalesce.Length = 0;
+        FdoData->Coalesce.Pages = 0;
+    }
+
+    return firstIrp;
+}
+
+
+/*
+ *  ClasspSendCoalescedRun
+ *
+ *      Send down a run of LBA-adjacent client irps linked through DriverContext[3].
+ *      A run of one irp is serviced as is.  Otherwise a carrier irp describes a
+ *      bounce buffer for the whole run with a single MDL, and is serviced like any
+ *      other client irp, so it becomes a single CDB.  The client MDLs are never
+ *      touched, so the port driver sees nothing it doesn't see already.  Writes are
+ *      copied into the bounce buffer here; ClasspCoalescedTransferComplete copies
+ *      reads out of it and completes the client irps.
+ */
+static VOID ClasspSendCoalescedRun(PDEVICE_OBJECT Fdo, PIRP FirstIrp, BOOLEAN PostToDpc)
+{
+    PFUNCTIONAL_DEVICE_EXTENSION fdoExt = Fdo->DeviceExtension;
+    PSTORAGE_ADAPTER_DESCRIPTOR adapterDesc = fdoExt->CommonExtension.PartitionZeroExtension->AdapterDescriptor;
+    PIO_STACK_LOCATION firstSp = IoGetCurrentIrpStackLocation(FirstIrp);
+    PIO_STACK_LOCATION carrierSp;
+    PIRP carrierIrp = NULL;
+    PMDL bounceMdl = NULL;
+    PUCHAR bounceBuffer = NULL;
+    PUCHAR clientBuffer;
+    PIRP irp;
+    PIRP nextIrp;
+    ULONG length;
+    ULONG offset;
+
+    if (FirstIrp->Tail.Overlay.DriverContext[3] != NULL) {
+
+        /*
+         *  Map every client buffer now, so that the completion routine can't
+         *  fail to copy a read out.  The mapping stays with the client MDL.
+         */
+        length = 0;
+        for (irp = FirstIrp; irp != NULL; irp = irp->Tail.Overlay.DriverContext[3]) {
+            if (MmGetSystemAddressForMdlSafe(irp->MdlAddress, NormalPagePriority | MdlMappingNoExecute) == NULL) {
+                length = 0;
+                break;
+            }
+            length += IoGetCurrentIrpStackLocation(irp)->Parameters.Read.Length;
+        }
+
+        if (length != 0) {
+            bounceBuffer = ExAllocatePoolWithTag(NonPagedPoolNxCacheAligned, length, CLASSPNP_POOL_TAG_COALESCE);
+        }
+
+        if ((bounceBuffer != NULL) && (((ULONG_PTR)bounceBuffer & adapterDesc->AlignmentMask) == 0)) {
+            bounceMdl = IoAllocateMdl(bounceBuffer, length, FALSE, FALSE, NULL);
+        }
+
+        if (bounceMdl != NULL) {
+            MmBuildMdlForNonPagedPool(bounceMdl);
+            carrierIrp = IoAllocateIrp(1, FALSE);
+        }
+
+        if (carrierIrp == NULL) {
+            if (bounceMdl != NULL) {
+                IoFreeMdl(bounceMdl);
+            }
+            if (bounceBuffer != NULL) {
+                ExFreePoolWithTag(bounceBuffer, CLASSPNP_POOL_TAG_COALESCE);
+            }
+        }
+    }
+
+    if (carrierIrp == NULL) {
+        /*
+         *  Either there is nothing to merge or we couldn't set the merged
+         *  transfer up.  Send the client irps down one by one.
+         */
+        for (irp = FirstIrp; irp != NULL; irp = nextIrp) {
+            nextIrp = irp->Tail.Overlay.DriverContext[3];
+            irp->Tail.Overlay.DriverContext[3] = NULL;
+            ServiceTransferRequest(Fdo, irp, PostToDpc);
+        }
+        return;
+    }
+
+    if (firstSp->MajorFunction == IRP_MJ_WRITE) {
+        offset = 0;
+        for (irp = FirstIrp; irp != NULL; irp = irp->Tail.Overlay.DriverContext[3]) {
+            ULONG clientLength = IoGetCurrentIrpStackLocation(irp)->Parameters.Write.Length;
+
+            clientBuffer = MmGetSystemAddressForMdlSafe(irp->MdlAddress, NormalPagePriority | MdlMappingNoExecute);
+            NT_ASSERT(clientBuffer != NULL);
+            RtlCopyMemory(bounceBuffer + offset, clientBuffer, clientLength);
+            offset += clientLength;
+        }
+    }
+
+    IoSetCompletionRoutine(carrierIrp, ClasspCoalescedTransferComplete, Fdo, TRUE, TRUE, TRUE);
+    IoSetNextIrpStackLocation(carrierIrp);
+
+    carrierSp = IoGetCurrentIrpStackLocation(carrierIrp);
+    carrierSp->MajorFunction = firstSp->MajorFunction;
+    carrierSp->Flags = firstSp->Flags;
+    carrierSp->DeviceObject = Fdo;
+    carrierSp->Parameters.Read.Length = length;
+    carrierSp->Parameters.Read.ByteOffset = firstSp->Parameters.Read.ByteOffset;
+
+    carrierIrp->MdlAddress = bounceMdl;
+    carrierIrp->Tail.Overlay.DriverContext[2] = FirstIrp;
+    carrierIrp->Tail.Overlay.DriverContext[3] = NULL;
+    IoSetIoPriorityHint(carrierIrp, IoGetIoPriorityHint(FirstIrp));
+    ClasspMarkIrpAsIdle(carrierIrp, FALSE);
+
+    /*
+     *  TransferPktComplete releases this when it completes the carrier irp.
+     *  Each client irp still holds the remove lock acquired in ClassReadWrite.
+     */
+    ClassAcquireRemoveLock(Fdo, carrierIrp);
+
+    TracePrint((TRACE_LEVEL_VERBOSE, TRACE_FLAG_RW, "ClasspSendCoalescedRun: sending irps starting with %p as %p (%u bytes).", FirstIrp, carrierIrp, length));
+
+    ServiceTransferRequest(Fdo, carrierIrp, PostToDpc);
+}
+
+
+/*
+ *  ClasspSendCoalescedBatch
+ *
+ *      Send down a batch detached with ClasspDetachCoalescedBatch.  The cancel
+ *      routines of the held irps are taken back first.  An irp whose cancel
+ *      routine has already been called is completed as cancelled, and the irps
+ *      around it go down as separate runs, since they are no longer adjacent.
+ */
+static VOID ClasspSendCoalescedBatch(PDEVICE_OBJECT Fdo, PIRP FirstIrp, BOOLEAN PostToDpc)
+{
+    PIRP runIrp = NULL;
+    PIRP lastIrp = NULL;
+    PIRP cancelledIrps = NULL;
+    PIRP irp;
+    PIRP nextIrp;
+    KIRQL cancelIrql;
+
+    for (irp = FirstIrp; irp != NULL; irp = nextIrp) {
+        nextIrp = irp->Tail.Overlay.DriverContext[3];
+        irp->Tail.Overlay.DriverContext[3] = NULL;
+
+        if (IoSetCancelRoutine(irp, NULL) == NULL) {
+            if (runIrp != NULL) {
+                ClasspSendCoalescedRun(Fdo, runIrp, PostToDpc);
+                runIrp = NULL;
+            }
+            irp->Tail.Overlay.DriverContext[3] = cancelledIrps;
+            cancelledIrps = irp;
+        } else if (runIrp == NULL) {
+            runIrp = irp;
+            lastIrp = irp;
+        } else {
+            lastIrp->Tail.Overlay.DriverContext[3] = irp;
+            lastIrp = irp;
+        }
+    }
+
+    if (runIrp != NULL) {
+        ClasspSendCoalescedRun(Fdo, runIrp, PostToDpc);
+    }
+
+    if (cancelledIrps != NULL) {
+        /*
+         *  The cancel routines may still hold the cancel spin lock; they are
+         *  done with the irps once they have released it.
+         */
+        IoAcquireCancelSpinLock(&cancelIrql);
+        IoReleaseCancelSpinLock(cancelIrql);
+
+        for (irp = cancelledIrps; irp != NULL; irp = nextIrp) {
+            nextIrp = irp->Tail.Overlay.DriverContext[3];
+            irp->Tail.Overlay.DriverContext[3] = NULL;
+
+            TracePrint((TRACE_LEVEL_INFORMATION, TRACE_FLAG_RW, "ClasspSendCoalescedBatch: completing cancelled irp %p.", irp));
+
+            irp->IoStatus.Status = STATUS_CANCELLED;
+            irp->IoStatus.Information = 0;
+            ClassReleaseRemoveLock(Fdo, irp);
+            ClassCompleteRequest(Fdo, irp, IO_NO_INCREMENT);
+        }
+    }
+}
+
+
+/*
+ *  ClasspCoalesceCancelRoutine
+ *
+ *      Cancel routine of a held-back client irp.  Whoever detaches the batch
+ *      completes the cancelled irp, so the batch is detached and sent now
+ *      rather than when the window expires.  Once the cancel spin lock is
+ *      released the irp may already be completed, so it is only compared against.
+ */
+VOID
+ClasspCoalesceCancelRoutine(
+    IN PDEVICE_OBJECT DeviceObject,
+    IN PIRP Irp
+    )
+{
+    PFUNCTIONAL_DEVICE_EXTENSION fdoExt = DeviceObject->DeviceExtension;
+    PCLASS_PRIVATE_FDO_DATA fdoData = fdoExt->PrivateFdoData;
+    PIRP firstIrp = NULL;
+    PIRP heldIrp;
+    KIRQL oldIrql;
+    UCHAR uniqueAddr = 0;
+
+    /*
+     *  The client irp's remove lock may go away with it.
+     */
+    ClassAcquireRemoveLock(DeviceObject, (PVOID)&uniqueAddr);
+
+    IoReleaseCancelSpinLock(Irp->CancelIrql);
+
+    KeAcquireSpinLock(&fdoData->Coalesce.Lock, &oldIrql);
+    for (heldIrp = fdoData->Coalesce.FirstIrp; heldIrp != NULL; heldIrp = heldIrp->Tail.Overlay.DriverContext[3]) {
+        if (heldIrp == Irp) {
+            firstIrp = ClasspDetachCoalescedBatch(fdoData);
+            break;
+        }
+    }
+    KeReleaseSpinLock(&fdoData->Coalesce.Lock, oldIrql);
+
+    if (firstIrp != NULL) {
+        ClasspSendCoalescedBatch(DeviceObject, firstIrp, TRUE);
+    }
+
+    ClassReleaseRemoveLock(DeviceObject, (PVOID)&uniqueAddr);
+}
+
+
+/*
+ *  ClasspCoalesceTransferRequest
+ *
+ *      Called for each client read/write before it is serviced.
+ *      While other transfers are outstanding, a small request is held back
+ *      so that the LBA-adjacent requests that follow it can be sent down with it
+ *      as a single transfer.  The batch is sent down when it is full, when the
+ *      next request isn't adjacent, when a packet completes, or at the latest
+ *      when the coalescing window expires.
+ *
+ *      Returns TRUE if the irp was held back (and marked pending),
+ *      FALSE if the caller has to service it now.
+ */
+BOOLEAN ClasspCoalesceTransferRequest(_In_ PDEVICE_OBJECT Fdo, _In_ PIRP Irp)
+{
+    PFUNCTIONAL_DEVICE_EXTENSION fdoExt = Fdo->DeviceExtension;
+    PCLASS_PRIVATE_FDO_DATA fdoData = fdoExt->PrivateFdoData;
+    PSTORAGE_ADAPTER_DESCRIPTOR adapterDesc = fdoExt->CommonExtension.PartitionZeroExtension->AdapterDescriptor;
+    PIO_STACK_LOCATION currentSp = IoGetCurrentIrpStackLocation(Irp);
+    ULONG length = currentSp->Parameters.Read.Length;
+    PIRP flushIrp = NULL;
+    BOOLEAN queued = FALSE;
+    ULONG pages;
+    KIRQL oldIrql;
+
+    if (fdoData->Coalesce.Window == 0) {
+        return FALSE;
+    }
+
+    /*
+     *  Only hold back small requests described by a single MDL.  Paging I/O,
+     *  requests with a key (e.g. copy-specific reads) and requests that are
+     *  already cancelled always go down on their own.  A held request gets a
+     *  cancel routine; a request cancelled before it was set just goes down
+     *  with its batch.
+     */
+    if ((Irp->MdlAddress == NULL) ||
+        (Irp->MdlAddress->Next != NULL) ||
+        (length == 0) ||
+        (length > COALESCE_MAX_REQUEST_LENGTH) ||
+        (MmGetMdlByteCount(Irp->MdlAddress) != length) ||
+        (MmGetMdlByteOffset(Irp->MdlAddress) & adapterDesc->AlignmentMask) ||
+        TEST_FLAG(Irp->Flags, IRP_PAGING_IO) ||
+        TEST_FLAG(currentSp->Flags, SL_KEY_SPECIFIED) ||
+        Irp->Cancel) {
+        return FALSE;
+    }
+
+    pages = ADDRESS_AND_SIZE_TO_SPAN_PAGES(MmGetMdlVirtualAddress(Irp->MdlAddress), length);
+
+    KeAcquireSpinLock(&fdoData->Coalesce.Lock, &oldIrql);
+
+    if (fdoData->Coalesce.FirstIrp != NULL) {
+        PIO_STACK_LOCATION firstSp = IoGetCurrentIrpStackLocation(fdoData->Coalesce.FirstIrp);
+
+        if ((currentSp->MajorFunction == firstSp->MajorFunction) &&
+            (currentSp->Flags == firstSp->Flags) &&
+            (currentSp->Parameters.Read.ByteOffset.QuadPart == fdoData->Coalesce.NextOffset.QuadPart) &&
+            (fdoData->Coalesce.Length + length <= fdoData->HwMaxXferLen) &&
+            (fdoData->Coalesce.Pages + pages < adapterDesc->MaximumPhysicalPages)) {
+
+            /*
+             *  Append to the batch.
+             */
+            Irp->Tail.Overlay.DriverContext[3] = NULL;
+            fdoData->Coalesce.LastIrp->Tail.Overlay.DriverContext[3] = Irp;
+            fdoData->Coalesce.LastIrp = Irp;
+            fdoData->Coalesce.IrpCount++;
+            fdoData->Coalesce.Length += length;
+            fdoData->Coalesce.Pages += pages;
+            fdoData->Coalesce.NextOffset.QuadPart += length;
+            IoMarkIrpPending(Irp);
+            IoSetCancelRoutine(Irp, ClasspCoalesceCancelRoutine);
+            queued = TRUE;
+
+            if (fdoData->Coalesce.IrpCount >= COALESCE_MAX_REQUESTS) {
+                flushIrp = ClasspDetachCoalescedBatch(fdoData);
+            }
+        } else {
+            /*
+             *  Not adjacent; the batch won't grow any further.
+             */
+            flushIrp = ClasspDetachCoalescedBatch(fdoData);
+        }
+    }
+
+    /*
+     *  Start a new batch with this irp, but only if there is a transfer
+     *  outstanding whose completion will send it down.  Otherwise there's
+     *  nothing to wait for, and the device is better off getting the request now.
+     */
+    if (!queued &&
+        (fdoData->Coalesce.OutstandingPackets > 0) &&
+        (pages < adapterDesc->MaximumPhysicalPages)) {
+
+        LARGE_INTEGER dueTime;
+
+        Irp->Tail.Overlay.DriverContext[3] = NULL;
+        fdoData->Coalesce.FirstIrp = Irp;
+        fdoData->Coalesce.LastIrp = Irp;
+        fdoData->Coalesce.IrpCount = 1;
+        fdoData->Coalesce.Length = length;
+        fdoData->Coalesce.Pages = pages;
+        fdoData->Coalesce.NextOffset.QuadPart = currentSp->Parameters.Read.ByteOffset.QuadPart + length;
+        IoMarkIrpPending(Irp);
+        IoSetCancelRoutine(Irp, ClasspCoalesceCancelRoutine);
+        queued = TRUE;
+
+        dueTime.QuadPart = -10 * (LONGLONG)fdoData->Coalesce.Window;
+        KeSetTimer(&fdoData->Coalesce.Timer, dueTime, &fdoData->Coalesce.Dpc);
+    }
+
+    KeReleaseSpinLock(&fdoData->Coalesce.Lock, oldIrql);
+
+    if (flushIrp != NULL) {
+        ClasspSendCoalescedBatch(Fdo, flushIrp, FALSE);
+    }
+
+    return queued;
+}
+
+
+/*
+ *  ClasspFlushCoalescedTransferRequests
+ *
+ *      Send down the client irps currently held back for coalescing, if any.
+ */
+VOID ClasspFlushCoalescedTransferRequests(_In_ PDEVICE_OBJECT Fdo, _In_ BOOLEAN PostToDpc)
+{
+    PFUNCTIONAL_DEVICE_EXTENSION fdoExt = Fdo->DeviceExtension;
+    PCLASS_PRIVATE_FDO_DATA fdoData = fdoExt->PrivateFdoData;
+    PIRP firstIrp;
+    KIRQL oldIrql;
+
+    if ((fdoData->Coalesce.Window == 0) || (fdoData->Coalesce.FirstIrp == NULL)) {
+        return;
+    }
+
+    KeAcquireSpinLock(&fdoData->Coalesce.Lock, &oldIrql);
+    firstIrp = ClasspDetachCoalescedBatch(fdoData);
+    KeReleaseSpinLock(&fdoData->Coalesce.Lock, oldIrql);
+
+    if (firstIrp != NULL) {
+        ClasspSendCoalescedBatch(Fdo, firstIrp, PostToDpc);
+    }
+}
+
+
+/*
+ *  ClasspCoalesceTimerDpc
+ *
+ *      Sends down the held-back client irps when the coalescing window expires
+ *      before any outstanding packet completed.
+ */
+VOID
+ClasspCoalesceTimerDpc(
+    IN PKDPC Dpc,
+    IN PVOID DeferredContext,
+    IN PVOID SystemArgument1,
+    IN PVOID SystemArgument2
+    )
+{
+    PDEVICE_OBJECT fdo = (PDEVICE_OBJECT)DeferredContext;
+    UCHAR uniqueAddr = 0;
+
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    ClassAcquireRemoveLock(fdo, (PVOID)&uniqueAddr);
+    ClasspFlushCoalescedTransferRequests(fdo, FALSE);
+    ClassReleaseRemoveLock(fdo, (PVOID)&uniqueAddr);
+}
+
+
+/*
+ *  ClasspCoalescedTransferComplete
+ *
+ *      Completion routine of a carrier irp built by ClasspSendCoalescedRun.
+ *      Copies reads out of the bounce buffer and completes each client irp with
+ *      the status of the merged transfer.  If the merged transfer ran out of
+ *      resources, the client irps are sent down again one by one instead.
+ */
+NTSTATUS
+ClasspCoalescedTransferComplete(
+    IN PDEVICE_OBJECT DeviceObject,
+    IN PIRP Irp,
+    IN PVOID Context
+    )
+{
+    PDEVICE_OBJECT fdo = (PDEVICE_OBJECT)Context;
+    NTSTATUS status = Irp->IoStatus.Status;
+    ULONG_PTR transferred = NT_SUCCESS(status) ? Irp->IoStatus.Information : 0;
+    PMDL bounceMdl = Irp->MdlAddress;
+    PUCHAR bounceBuffer = MmGetMdlVirtualAddress(bounceMdl);
+    PUCHAR clientBuffer;
+    ULONG offset = 0;
+    ULONG clientTransferred;
+    PIRP origIrp;
+    PIRP nextIrp;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    for (origIrp = Irp->Tail.Overlay.DriverContext[2]; origIrp != NULL; origIrp = nextIrp) {
+        PIO_STACK_LOCATION origSp = IoGetCurrentIrpStackLocation(origIrp);
+        ULONG clientLength = origSp->Parameters.Read.Length;
+
+        nextIrp = origIrp->Tail.Overlay.DriverContext[3];
+        origIrp->Tail.Overlay.DriverContext[3] = NULL;
+
+        if (status == STATUS_INSUFFICIENT_RESOURCES) {
+            ServiceTransferRequest(fdo, origIrp, TRUE);
+            offset += clientLength;
+            continue;
+        }
+
+        /*
+         *  Each client irp gets its share of what the merged transfer moved.
+         */
+        clientTransferred = (transferred > offset) ? (ULONG)MIN(transferred - offset, clientLength) : 0;
+
+        if ((origSp->MajorFunction == IRP_MJ_READ) && (clientTransferred != 0)) {
+            clientBuffer = MmGetSystemAddressForMdlSafe(origIrp->MdlAddress, NormalPagePriority | MdlMappingNoExecute);
+            NT_ASSERT(clientBuffer != NULL);
+            RtlCopyMemory(clientBuffer, bounceBuffer + offset, clientTransferred);
+        }
+
+        offset += clientLength;
+
+        origIrp->IoStatus.Status = status;
+        origIrp->IoStatus.Information = clientTransferred;
+
+        if (!NT_SUCCESS(status) &&
+            IoIsErrorUserInduced(status) &&
+            origIrp->Tail.Overlay.Thread) {
+
+            IoSetHardErrorOrVerifyDevice(origIrp, fdo);
+        }
+
+        ClassReleaseRemoveLock(fdo, origIrp);
+        ClassCompleteRequest(fdo, origIrp, IO_DISK_INCREMENT);
+    }
+
+    Irp->MdlAddress = NULL;
+    IoFreeMdl(bounceMdl);
+    ExFreePoolWithTag(bounceBuffer, CLASSPNP_POOL_TAG_COALESCE);
+    IoFreeIrp(Irp);
+
+    return STATUS_MORE_PROCESSING_REQUIRED;
+}
+
+
 /*
  *  SetupEjectionTransferPacket
  *
@@ -1600,7 +2313,7 @@ Arguments:
     PSINGLE_LIST_ENTRY slistEntry;
     PTRANSFER_PACKET pktToDelete;
     ULONG requiredNumPktToDelete = fdoData->FreeTransferPacketsLists[Node].NumTotalTransferPackets -
-                                   fdoData->LocalMaxWorkingSetTransferPackets;
+                                   fdoData->FreeTransferPacketsLists[Node].MaxWorkingSetTransferPackets;
 
     if (LimitNumPktToDelete) {
         requiredNumPktToDelete = MIN(requiredNumPktToDelete, MAX_CLEANUP_TRANSFER_PACKETS_AT_ONCE);
@@ -1620,7 +2333,7 @@ Arguments:
     SimpleInitSlistHdr(&pktList);
     KeAcquireSpinLock(&fdoData->SpinLock, &oldIrql);
     while ((fdoData->FreeTransferPacketsLists[Node].NumFreeTransferPackets >= fdoData->FreeTransferPacketsLists[Node].NumTotalTransferPackets) &&
-           (fdoData->FreeTransferPacketsLists[Node].NumTotalTransferPackets > fdoData->LocalMaxWorkingSetTransferPackets) &&
+           (fdoData->FreeTransferPacketsLists[Node].NumTotalTransferPackets > fdoData->FreeTransferPacketsLists[Node].MaxWorkingSetTransferPackets) &&
            (requiredNumPktToDelete--)){
 
         pktToDelete = DequeueFreeTransferPacketEx(Fdo, FALSE, Node);
@@ -1631,7 +2344,7 @@ Arguments:
         } else {
             TracePrint((TRACE_LEVEL_INFORMATION, TRACE_FLAG_RW,
                 "Extremely unlikely condition (non-fatal): %d packets dequeued at once for Fdo %p. NumTotalTransferPackets=%d (1). Node=%d",
-                fdoData->LocalMaxWorkingSetTransferPackets,
+                fdoData->FreeTransferPacketsLists[Node].MaxWorkingSetTransferPackets,
                 Fdo,
                 fdoData->FreeTransferPacketsLists[Node].NumTotalTransferPackets,
                 Node));
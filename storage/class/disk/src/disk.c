@@ -53,6 +53,7 @@ Revision History:
 #pragma alloc_text(PAGE, DiskGetInfoExceptionInformation)
 #pragma alloc_text(PAGE, DiskIoctlGetCacheSetting)
 #pragma alloc_text(PAGE, DiskIoctlSetCacheSetting)
+#pragma alloc_text(PAGE, DiskReadDriveCapacityCached)
 #pragma alloc_text(PAGE, DiskIoctlGetLengthInfo)
 #pragma alloc_text(PAGE, DiskIoctlGetDriveGeometry)
 #pragma alloc_text(PAGE, DiskIoctlGetDriveGeometryEx)
@@ -639,6 +640,16 @@ Return Value:
 
     Irp->IoStatus.Status = status;
 
+    //
+    // Complete sequential reads from the read-ahead cache when possible.
+    //
+
+    if (NT_SUCCESS(status) &&
+        DiskReadAheadProcessRequest(DeviceObject, Irp)) {
+
+        status = STATUS_PENDING;
+    }
+
     return status;
 
 } // end DiskReadWrite()
@@ -962,6 +973,16 @@ Return Value:
     TracePrint((TRACE_LEVEL_VERBOSE, TRACE_FLAG_IOCTL, "DiskDeviceControl: Received IOCTL 0x%X for device %p through IRP %p\n",
                 ioctlCode, DeviceObject, Irp));
 
+    //
+    // Any IOCTL that requires write access (pass-through, trim, block
+    // reassignment, layout and size updates...) may change the media
+    // contents underneath the read-ahead cache, or the capacity.
+    //
+
+    if (TEST_FLAG((ioctlCode >> 14) & 3, FILE_WRITE_ACCESS)) {
+        DiskReadAheadInvalidate(DeviceObject);
+        DiskInvalidateCapacityCache(DeviceObject);
+    }
 
     switch (ioctlCode) {
 
@@ -2552,6 +2573,16 @@ Return Value:
             } // end switch(Srb->SrbStatus)
         }
 
+        if (invalidatePartitionTable) {
+
+            //
+            // Unit attentions (media or capacity changed), missing media and
+            // lost devices all mean the cached capacity can no longer be trusted.
+            //
+
+            DiskInvalidateCapacityCache(Fdo);
+        }
+
         if (invalidatePartitionTable && TEST_FLAG(Fdo->Characteristics, FILE_REMOVABLE_MEDIA)) {
 
             //
@@ -3455,6 +3486,96 @@ Return Value:
     return status;
 }
 
+VOID
+DiskInvalidateCapacityCache(
+    IN PDEVICE_OBJECT DeviceObject
+    )
+
+/*++
+
+Routine Description:
+
+    This routine invalidates the cached capacity and geometry of the disk,
+    so that the next query sends READ CAPACITY to the device again.
+
+    This function may be called at IRQL <= DISPATCH_LEVEL.
+
+Arguments:
+
+    DeviceObject - Supplies the device object associated with the disk.
+
+Return Value:
+
+    None
+
+--*/
+
+{
+    PCOMMON_DEVICE_EXTENSION commonExtension = DeviceObject->DeviceExtension;
+    PDISK_DATA diskData = (PDISK_DATA)(commonExtension->PartitionZeroExtension->CommonExtension.DriverData);
+
+    InterlockedIncrement(&diskData->CapacityGeneration);
+
+    return;
+}
+
+NTSTATUS
+DiskReadDriveCapacityCached(
+    IN PDEVICE_OBJECT Fdo
+    )
+
+/*++
+
+Routine Description:
+
+    This routine makes sure the capacity and geometry in the device
+    extension are current.  If nothing that may change them has happened
+    since the last successful READ CAPACITY, it returns without device I/O;
+    otherwise it calls DiskReadDriveCapacity.
+
+    This function must be called at IRQL < DISPATCH_LEVEL.
+
+Arguments:
+
+    Fdo - Supplies the functional device object of the disk.
+
+Return Value:
+
+    NTSTATUS code of DiskReadDriveCapacity, or STATUS_SUCCESS if the
+    cached capacity is current.
+
+--*/
+
+{
+    PFUNCTIONAL_DEVICE_EXTENSION fdoExtension = Fdo->DeviceExtension;
+    PDISK_DATA diskData = (PDISK_DATA)(fdoExtension->CommonExtension.DriverData);
+    LONG generation;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    generation = diskData->CapacityGeneration;
+
+    if ((diskData->CachedCapacityGeneration == generation) &&
+        !TEST_FLAG(Fdo->Flags, DO_VERIFY_VOLUME)) {
+        return STATUS_SUCCESS;
+    }
+
+    status = DiskReadDriveCapacity(Fdo);
+
+    //
+    // Only mark the answer current if nothing invalidated the cache while
+    // READ CAPACITY was outstanding; in that case the generation has moved
+    // on and the next query reads the capacity again.
+    //
+
+    if (NT_SUCCESS(status)) {
+        InterlockedExchange(&diskData->CachedCapacityGeneration, generation);
+    }
+
+    return status;
+}
+
 NTSTATUS
 DiskIoctlGetLengthInfo(
     IN OUT PDEVICE_OBJECT DeviceObject,
@@ -3516,10 +3637,11 @@ Return Value:
     }
 
     //
-    // Update the geometry in case it has changed
+    // Update the geometry in case it has changed.  This is answered from
+    // the capacity cache unless the capacity or media may have changed.
     //
 
-    status = DiskReadDriveCapacity(p0Extension->DeviceObject);
+    status = DiskReadDriveCapacityCached(p0Extension->DeviceObject);
 
     //
     // Note whether the drive is ready.  If the status has changed then
@@ -3597,10 +3719,10 @@ Return Value:
 
         //
         // Issue ReadCapacity to update device extension
-        // with information for current media.
+        // with information for current media, unless it is cached.
         //
 
-        status = DiskReadDriveCapacity(commonExtension->PartitionZeroExtension->DeviceObject);
+        status = DiskReadDriveCapacityCached(commonExtension->PartitionZeroExtension->DeviceObject);
 
         //
         // Note whether the drive is ready.
@@ -3712,10 +3834,10 @@ Return Value:
 
         //
         // Issue a ReadCapacity to update device extension
-        // with information for the current media.
+        // with information for the current media, unless it is cached.
         //
 
-        status = DiskReadDriveCapacity(commonExtension->PartitionZeroExtension->DeviceObject);
+        status = DiskReadDriveCapacityCached(commonExtension->PartitionZeroExtension->DeviceObject);
 
         diskData->ReadyStatus = status;
 
@@ -5479,7 +5601,7 @@ Return Value:
             return STATUS_BUFFER_TOO_SMALL;
         }
 
-        status = DiskReadDriveCapacity(commonExtension->PartitionZeroExtension->DeviceObject);
+        status = DiskReadDriveCapacityCached(commonExtension->PartitionZeroExtension->DeviceObject);
 
         //
         // Note whether the drive is ready.
@@ -63,6 +63,7 @@ Revision History:
 #define DISK_CACHE_MBR_CHECK    'mDcS'  // "ScDM" - mbr checksum code
 #define DISK_TAG_NAME           'NDcS'  // "ScDN" - disk name code
 #define DISK_TAG_READ_CAP       'PDcS'  // "ScDP" - read capacity buffer
+#define DISK_TAG_READ_AHEAD     'RDcS'  // "ScDR" - read-ahead cache windows
 #define DISK_TAG_PART_LIST      'pDcS'  // "ScDp" - disk partition lists
 #define DISK_TAG_SRB            'SDcS'  // "ScDS" - srb allocation
 #define DISK_TAG_START          'sDcS'  // "ScDs" - start device paths
@@ -173,6 +174,105 @@ typedef enum _DISK_USER_WRITE_CACHE_SETTING
 
 } DISK_USER_WRITE_CACHE_SETTING, *PDISK_USER_WRITE_CACHE_SETTING;
 
+//
+// Read-ahead cache.
+//
+// When enabled through the ReadAheadSizeKB device parameter, sequential read
+// streams are detected per device and the data following the stream is
+// prefetched into a small, fixed number of windows.  Reads that fall entirely
+// within a prefetched window are completed from it; any write that overlaps a
+// window invalidates it.
+//
+
+#define DISK_READ_AHEAD_WINDOWS                 2
+#define DISK_READ_AHEAD_MAX_SIZE_KB             1024
+#define DISK_READ_AHEAD_SEQUENTIAL_THRESHOLD    2
+
+typedef enum _DISK_READ_AHEAD_STATE
+{
+    DiskReadAheadIdle = 0,
+    DiskReadAheadPending,
+    DiskReadAheadValid
+
+} DISK_READ_AHEAD_STATE, *PDISK_READ_AHEAD_STATE;
+
+typedef struct _DISK_READ_AHEAD_CACHE *PDISK_READ_AHEAD_CACHE;
+
+typedef struct _DISK_READ_AHEAD_WINDOW
+{
+    PDISK_READ_AHEAD_CACHE Cache;
+
+    DISK_READ_AHEAD_STATE State;
+
+    //
+    // Set when a write overlaps the window while its prefetch is in flight.
+    //
+
+    BOOLEAN Invalidated;
+
+    LARGE_INTEGER Offset;
+    ULONG Length;
+
+    PVOID Buffer;
+    PMDL Mdl;
+    PIRP Irp;
+
+} DISK_READ_AHEAD_WINDOW, *PDISK_READ_AHEAD_WINDOW;
+
+typedef struct _DISK_READ_AHEAD_CACHE
+{
+    PDEVICE_OBJECT DeviceObject;
+
+    //
+    // Size of each window in bytes.  Zero if read-ahead is disabled.
+    //
+
+    ULONG WindowSize;
+
+    KSPIN_LOCK Lock;
+
+    //
+    // Sequential stream detection.
+    //
+
+    LARGE_INTEGER StreamNextOffset;
+    ULONG SequentialCount;
+
+    DISK_READ_AHEAD_WINDOW Windows[DISK_READ_AHEAD_WINDOWS];
+
+    //
+    // Statistics reported through WMI.
+    //
+
+    ULONGLONG ReadHits;
+    ULONGLONG ReadMisses;
+    ULONGLONG BytesHit;
+    ULONGLONG Prefetches;
+    ULONGLONG Invalidations;
+
+} DISK_READ_AHEAD_CACHE;
+
+//
+// Data block of WMI_DISK_READ_AHEAD_STATISTICS_GUID.  Disk has no MOF of its
+// own, so the block is retrieved by GUID.
+//
+// {c1d7e5a4-2f6b-4d53-9a0e-6b1f3c8e7d21}
+//
+#define WMI_DISK_READ_AHEAD_STATISTICS_GUID \
+    { 0xc1d7e5a4, 0x2f6b, 0x4d53, { 0x9a, 0x0e, 0x6b, 0x1f, 0x3c, 0x8e, 0x7d, 0x21 } }
+
+typedef struct _DISK_READ_AHEAD_STATISTICS
+{
+    ULONG WindowSize;
+    ULONG NumberOfWindows;
+    ULONGLONG ReadHits;
+    ULONGLONG ReadMisses;
+    ULONGLONG BytesHit;
+    ULONGLONG Prefetches;
+    ULONGLONG Invalidations;
+
+} DISK_READ_AHEAD_STATISTICS, *PDISK_READ_AHEAD_STATISTICS;
+
 typedef struct _DISK_DATA {
 
     //
@@ -373,6 +473,21 @@ typedef struct _DISK_DATA {
 
     DISK_USER_WRITE_CACHE_SETTING WriteCacheOverride;
 
+    //
+    // Read-ahead cache for sequential read streams
+    //
+
+    DISK_READ_AHEAD_CACHE ReadAhead;
+
+    //
+    // Capacity cache.  CapacityGeneration is advanced whenever the capacity,
+    // geometry or media may have changed.  While CachedCapacityGeneration
+    // matches it, the capacity and geometry in the device extension are
+    // current and queries are answered without sending READ CAPACITY.
+    //
+
+    volatile LONG CapacityGeneration;
+    volatile LONG CachedCapacityGeneration;
 
 } DISK_DATA, *PDISK_DATA;
 
@@ -392,6 +507,7 @@ typedef struct _DISK_DATA {
 #define DiskDeviceParameterSubkey           L"Disk"
 #define DiskDeviceUserWriteCacheSetting     L"UserWriteCacheSetting"
 #define DiskDeviceCacheIsPowerProtected     L"CacheIsPowerProtected"
+#define DiskDeviceReadAheadSizeKB           L"ReadAheadSizeKB"
 
 
 #define FUNCTIONAL_EXTENSION_SIZE sizeof(FUNCTIONAL_DEVICE_EXTENSION) + sizeof(DISK_DATA)
@@ -508,6 +624,33 @@ DiskReadWriteVerification(
     IN PIRP Irp
     );
 
+VOID
+DiskInitializeReadAhead(
+    IN PDEVICE_OBJECT Fdo
+    );
+
+VOID
+DiskFreeReadAhead(
+    IN PDEVICE_OBJECT Fdo
+    );
+
+BOOLEAN
+DiskReadAheadProcessRequest(
+    IN PDEVICE_OBJECT DeviceObject,
+    IN PIRP Irp
+    );
+
+VOID
+DiskReadAheadInvalidate(
+    IN PDEVICE_OBJECT DeviceObject
+    );
+
+VOID
+DiskReadAheadQueryStatistics(
+    IN PDEVICE_OBJECT DeviceObject,
+    OUT PDISK_READ_AHEAD_STATISTICS Statistics
+    );
+
 NTSTATUS
 DiskDeviceControl(
     IN PDEVICE_OBJECT DeviceObject,
@@ -783,6 +926,16 @@ DiskReadDriveCapacity(
 #define DiskReadDriveCapacity(Fdo)  ClassReadDriveCapacity(Fdo)
 #endif
 
+NTSTATUS
+DiskReadDriveCapacityCached(
+    IN PDEVICE_OBJECT Fdo
+    );
+
+VOID
+DiskInvalidateCapacityCache(
+    IN PDEVICE_OBJECT DeviceObject
+    );
+
 
 #if defined(_X86_) || defined(_AMD64_)
 
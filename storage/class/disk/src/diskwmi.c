@@ -131,6 +131,12 @@ GUIDREGINFO DiskWmiFdoGuidList[] =
         WMI_STORAGE_SCSI_INFO_EXCEPTIONS_GUID,
         1,
         0
+    },
+
+    {
+        WMI_DISK_READ_AHEAD_STATISTICS_GUID,
+        1,
+        0
     }
 };
 
@@ -150,6 +156,7 @@ GUID DiskPredictFailureEventGuid = WMI_STORAGE_PREDICT_FAILURE_EVENT_GUID;
 #define SmartEventGuid             4
 #define SmartThresholdsGuid        5
 #define ScsiInfoExceptionsGuid     6
+#define ReadAheadStatisticsGuid    7
 
 #ifdef ALLOC_PRAGMA
 
@@ -2839,6 +2846,21 @@ Return Value:
             break;
         }
 
+        case ReadAheadStatisticsGuid:
+        {
+            sizeNeeded = sizeof(DISK_READ_AHEAD_STATISTICS);
+            if (BufferAvail >= sizeNeeded)
+            {
+                DiskReadAheadQueryStatistics(DeviceObject,
+                                             (PDISK_READ_AHEAD_STATISTICS)Buffer);
+                status = STATUS_SUCCESS;
+            } else {
+                status = STATUS_BUFFER_TOO_SMALL;
+            }
+
+            break;
+        }
+
         default:
         {
             sizeNeeded = 0;
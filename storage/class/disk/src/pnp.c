@@ -564,6 +564,13 @@ Return Value:
 
     KeInitializeMutex(&diskData->VerifyMutex, MAX_SECTORS_PER_VERIFY);
 
+    //
+    // Start with an invalid capacity cache
+    //
+
+    diskData->CapacityGeneration = 1;
+    diskData->CachedCapacityGeneration = 0;
+
     //
     // Initialize the flush group context
     //
@@ -888,6 +895,7 @@ Return Value:
 
     if (Type == IRP_MN_REMOVE_DEVICE)
     {
+        DiskFreeReadAhead(DeviceObject);
         ClassDeleteSrbLookasideList(commonExtension);
     }
 
@@ -1092,6 +1100,12 @@ Return Value:
 
     ADJUST_FUA_FLAG(fdoExtension);
 
+    //
+    // Set up the read-ahead cache if the user has enabled it
+    //
+
+    DiskInitializeReadAhead(Fdo);
+
     return STATUS_SUCCESS;
 
 } // end DiskStartFdo()
@@ -0,0 +1,750 @@
+/*++
+
+Copyright (C) Microsoft Corporation, 1991 - 2010
+
+Module Name:
+
+    readahead.c
+
+Abstract:
+
+    SCSI disk class driver - this module contains the optional read-ahead
+    cache for sequential read streams.
+
+Environment:
+
+    kernel mode only
+
+Notes:
+
+    The cache is disabled unless the ReadAheadSizeKB value is set under the
+    device's "Disk" device parameters key.  Each device owns a small, fixed
+    number of windows of that size.  Once a device sees a sequential read
+    stream, the data following the stream is prefetched into a free window by
+    sending a read to the device itself, so that it goes through the regular
+    classpnp transfer path.  Reads that fall entirely within a valid window
+    are completed from it.
+
+    Any write that overlaps a window, as well as any device control that may
+    change the media contents, invalidates the affected windows.  Writes that
+    are already in flight when a prefetch is issued are not tracked, so the
+    cache should only be enabled for devices whose streams are read-mostly.
+
+Revision History:
+
+--*/
+
+#include "disk.h"
+
+#ifdef DEBUG_USE_WPP
+#include "readahead.tmh"
+#endif
+
+IO_COMPLETION_ROUTINE DiskReadAheadCompletion;
+
+VOID
+DiskReadAheadStartPrefetch(
+    IN PDISK_READ_AHEAD_CACHE Cache,
+    IN PDISK_READ_AHEAD_WINDOW Window
+    );
+
+#ifdef ALLOC_PRAGMA
+
+#pragma alloc_text(PAGE, DiskInitializeReadAhead)
+#pragma alloc_text(PAGE, DiskFreeReadAhead)
+
+#endif
+
+
+VOID
+DiskInitializeReadAhead(
+    IN PDEVICE_OBJECT Fdo
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads the read-ahead settings for the device from the
+    registry and allocates the read-ahead windows if read-ahead is enabled.
+    It is called every time the device is started; the windows are only
+    allocated the first time.
+
+Arguments:
+
+    Fdo - a pointer to the functional device object for this device
+
+Return Value:
+
+    none
+
+--*/
+
+{
+    PFUNCTIONAL_DEVICE_EXTENSION fdoExtension = Fdo->DeviceExtension;
+    PDISK_DATA diskData = fdoExtension->CommonExtension.DriverData;
+    PDISK_READ_AHEAD_CACHE cache = &diskData->ReadAhead;
+    PDISK_READ_AHEAD_WINDOW window;
+    ULONG readAheadSizeKB = 0;
+    ULONG windowSize;
+    ULONG i;
+
+    PAGED_CODE();
+
+    if (cache->WindowSize != 0) {
+        return;
+    }
+
+    //
+    // Read-ahead makes no sense for removable media, where the media
+    // can change underneath the cache.
+    //
+
+    if (TEST_FLAG(Fdo->Characteristics, FILE_REMOVABLE_MEDIA)) {
+        return;
+    }
+
+    ClassGetDeviceParameter(fdoExtension,
+                            DiskDeviceParameterSubkey,
+                            DiskDeviceReadAheadSizeKB,
+                            &readAheadSizeKB);
+
+    if (readAheadSizeKB == 0) {
+        return;
+    }
+
+    if (readAheadSizeKB > DISK_READ_AHEAD_MAX_SIZE_KB) {
+        readAheadSizeKB = DISK_READ_AHEAD_MAX_SIZE_KB;
+    }
+
+    windowSize = readAheadSizeKB * 1024;
+
+    if ((fdoExtension->DiskGeometry.BytesPerSector == 0) ||
+        (windowSize < fdoExtension->DiskGeometry.BytesPerSector)) {
+        return;
+    }
+
+    windowSize &= ~(fdoExtension->DiskGeometry.BytesPerSector - 1);
+
+    KeInitializeSpinLock(&cache->Lock);
+    cache->DeviceObject = Fdo;
+    cache->StreamNextOffset.QuadPart = -1;
+    cache->SequentialCount = 0;
+
+    for (i = 0; i < DISK_READ_AHEAD_WINDOWS; i++) {
+
+        window = &cache->Windows[i];
+
+        window->Cache = cache;
+        window->State = DiskReadAheadIdle;
+
+        window->Buffer = ExAllocatePoolWithTag(NonPagedPoolNxCacheAligned,
+                                               windowSize,
+                                               DISK_TAG_READ_AHEAD);
+
+        if (window->Buffer == NULL) {
+            break;
+        }
+
+        window->Mdl = IoAllocateMdl(window->Buffer, windowSize, FALSE, FALSE, NULL);
+
+        if (window->Mdl == NULL) {
+            break;
+        }
+
+        MmBuildMdlForNonPagedPool(window->Mdl);
+
+        window->Irp = IoAllocateIrp(Fdo->StackSize, FALSE);
+
+        if (window->Irp == NULL) {
+            break;
+        }
+    }
+
+    if (i < DISK_READ_AHEAD_WINDOWS) {
+
+        TracePrint((TRACE_LEVEL_WARNING, TRACE_FLAG_PNP, "DiskInitializeReadAhead: Unable to allocate read-ahead windows for %p\n", Fdo));
+
+        DiskFreeReadAhead(Fdo);
+        return;
+    }
+
+    //
+    // Publish the window size last; a non-zero size enables the cache.
+    //
+
+    InterlockedExchange((volatile LONG *)&cache->WindowSize, (LONG)windowSize);
+
+    TracePrint((TRACE_LEVEL_INFORMATION, TRACE_FLAG_PNP, "DiskInitializeReadAhead: Read-ahead enabled for %p with %lu byte windows\n", Fdo, windowSize));
+
+    return;
+
+} // end DiskInitializeReadAhead()
+
+
+VOID
+DiskFreeReadAhead(
+    IN PDEVICE_OBJECT Fdo
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees the read-ahead windows of the device.  It must only be
+    called once no more I/O can reach the device, as every prefetch holds
+    the remove lock.
+
+Arguments:
+
+    Fdo - a pointer to the functional device object for this device
+
+Return Value:
+
+    none
+
+--*/
+
+{
+    PFUNCTIONAL_DEVICE_EXTENSION fdoExtension = Fdo->DeviceExtension;
+    PDISK_DATA diskData = fdoExtension->CommonExtension.DriverData;
+    PDISK_READ_AHEAD_CACHE cache = &diskData->ReadAhead;
+    PDISK_READ_AHEAD_WINDOW window;
+    ULONG i;
+
+    PAGED_CODE();
+
+    cache->WindowSize = 0;
+
+    for (i = 0; i < DISK_READ_AHEAD_WINDOWS; i++) {
+
+        window = &cache->Windows[i];
+
+        NT_ASSERT(window->State != DiskReadAheadPending);
+
+        if (window->Irp != NULL) {
+            IoFreeIrp(window->Irp);
+            window->Irp = NULL;
+        }
+
+        if (window->Mdl != NULL) {
+            IoFreeMdl(window->Mdl);
+            window->Mdl = NULL;
+        }
+
+        FREE_POOL(window->Buffer);
+
+        window->State = DiskReadAheadIdle;
+    }
+
+    return;
+
+} // end DiskFreeReadAhead()
+
+
+NTSTATUS
+DiskReadAheadCompletion(
+    IN PDEVICE_OBJECT DeviceObject,
+    IN PIRP Irp,
+    IN PVOID Context
+    )
+
+/*++
+
+Routine Description:
+
+    Completion routine of a prefetch.  Marks the window valid, unless the
+    prefetch failed or a write overlapped the window while it was in flight.
+
+Arguments:
+
+    DeviceObject - NULL, the prefetch irp has no stack location of its own
+
+    Irp - the prefetch irp
+
+    Context - the read-ahead window
+
+Return Value:
+
+    STATUS_MORE_PROCESSING_REQUIRED - the irp is owned by the window
+
+--*/
+
+{
+    PDISK_READ_AHEAD_WINDOW window = Context;
+    PDISK_READ_AHEAD_CACHE cache = window->Cache;
+    KIRQL oldIrql;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    KeAcquireSpinLock(&cache->Lock, &oldIrql);
+
+    NT_ASSERT(window->State == DiskReadAheadPending);
+
+    if (NT_SUCCESS(Irp->IoStatus.Status) &&
+        (Irp->IoStatus.Information == window->Length) &&
+        !window->Invalidated) {
+
+        window->State = DiskReadAheadValid;
+
+    } else {
+
+        window->State = DiskReadAheadIdle;
+    }
+
+    KeReleaseSpinLock(&cache->Lock, oldIrql);
+
+    ClassReleaseRemoveLock(cache->DeviceObject, Irp);
+
+    return STATUS_MORE_PROCESSING_REQUIRED;
+
+} // end DiskReadAheadCompletion()
+
+
+VOID
+DiskReadAheadStartPrefetch(
+    IN PDISK_READ_AHEAD_CACHE Cache,
+    IN PDISK_READ_AHEAD_WINDOW Window
+    )
+
+/*++
+
+Routine Description:
+
+    Sends the read for a window that has been marked pending to the device.
+    The read goes through ClassReadWrite, so it is split, retried and
+    throttled like any other request.
+
+Arguments:
+
+    Cache - the read-ahead cache of the device
+
+    Window - the pending window, with its Offset and Length set
+
+Return Value:
+
+    none
+
+--*/
+
+{
+    PDEVICE_OBJECT deviceObject = Cache->DeviceObject;
+    PIRP irp = Window->Irp;
+    PIO_STACK_LOCATION nextIrpStack;
+    KIRQL oldIrql;
+
+    if (ClassAcquireRemoveLock(deviceObject, irp)) {
+
+        ClassReleaseRemoveLock(deviceObject, irp);
+
+        KeAcquireSpinLock(&Cache->Lock, &oldIrql);
+        Window->State = DiskReadAheadIdle;
+        KeReleaseSpinLock(&Cache->Lock, oldIrql);
+
+        return;
+    }
+
+    IoReuseIrp(irp, STATUS_SUCCESS);
+
+    irp->MdlAddress = Window->Mdl;
+    irp->Tail.Overlay.Thread = NULL;
+
+    nextIrpStack = IoGetNextIrpStackLocation(irp);
+    nextIrpStack->MajorFunction = IRP_MJ_READ;
+    nextIrpStack->Parameters.Read.Length = Window->Length;
+    nextIrpStack->Parameters.Read.ByteOffset = Window->Offset;
+
+    IoSetCompletionRoutine(irp, DiskReadAheadCompletion, Window, TRUE, TRUE, TRUE);
+
+    TracePrint((TRACE_LEVEL_VERBOSE, TRACE_FLAG_RW, "DiskReadAheadStartPrefetch: Device %p prefetching %lu bytes at %I64x\n",
+                deviceObject, Window->Length, Window->Offset.QuadPart));
+
+    IoCallDriver(deviceObject, irp);
+
+    return;
+
+} // end DiskReadAheadStartPrefetch()
+
+
+BOOLEAN
+DiskReadAheadProcessRequest(
+    IN PDEVICE_OBJECT DeviceObject,
+    IN PIRP Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called for every read or write that passed verification.
+    Writes invalidate the windows they overlap.  Reads are completed from a
+    valid window if they fall entirely within it, and drive the sequential
+    stream detection that starts new prefetches.
+
+Arguments:
+
+    DeviceObject - the device object the request was sent to
+
+    Irp - the read or write request
+
+Return Value:
+
+    TRUE if the request was completed from the cache, in which case the irp
+    must not be touched anymore.  FALSE if it must be sent to the device.
+
+--*/
+
+{
+    PCOMMON_DEVICE_EXTENSION commonExtension = DeviceObject->DeviceExtension;
+    PDISK_DATA diskData = commonExtension->DriverData;
+    PDISK_READ_AHEAD_CACHE cache = &diskData->ReadAhead;
+    PIO_STACK_LOCATION irpSp = IoGetCurrentIrpStackLocation(Irp);
+    PDISK_READ_AHEAD_WINDOW window;
+    PDISK_READ_AHEAD_WINDOW hitWindow = NULL;
+    PDISK_READ_AHEAD_WINDOW prefetchWindow = NULL;
+    LARGE_INTEGER startOffset;
+    LARGE_INTEGER endOffset;
+    LARGE_INTEGER prefetchOffset;
+    ULONGLONG bytesRemaining;
+    ULONG length;
+    ULONG bytesPerSector;
+    PVOID systemBuffer;
+    KIRQL oldIrql;
+    ULONG i;
+
+    if ((cache->WindowSize == 0) || !commonExtension->IsFdo) {
+        return FALSE;
+    }
+
+    length = irpSp->Parameters.Read.Length;
+    startOffset = irpSp->Parameters.Read.ByteOffset;
+    endOffset.QuadPart = startOffset.QuadPart + length;
+
+    if (length == 0) {
+        return FALSE;
+    }
+
+    //
+    // Our own prefetches pass through here as well.
+    //
+
+    for (i = 0; i < DISK_READ_AHEAD_WINDOWS; i++) {
+        if (Irp == cache->Windows[i].Irp) {
+            return FALSE;
+        }
+    }
+
+    KeAcquireSpinLock(&cache->Lock, &oldIrql);
+
+    if (irpSp->MajorFunction == IRP_MJ_WRITE) {
+
+        //
+        // Invalidate every window the write overlaps.
+        //
+
+        for (i = 0; i < DISK_READ_AHEAD_WINDOWS; i++) {
+
+            window = &cache->Windows[i];
+
+            if ((window->State != DiskReadAheadIdle) &&
+                (startOffset.QuadPart < window->Offset.QuadPart + window->Length) &&
+                (endOffset.QuadPart > window->Offset.QuadPart)) {
+
+                if (window->State == DiskReadAheadPending) {
+                    window->Invalidated = TRUE;
+                } else {
+                    window->State = DiskReadAheadIdle;
+                }
+
+                cache->Invalidations++;
+            }
+        }
+
+        KeReleaseSpinLock(&cache->Lock, oldIrql);
+
+        return FALSE;
+    }
+
+    NT_ASSERT(irpSp->MajorFunction == IRP_MJ_READ);
+
+    //
+    // Track the sequential stream.
+    //
+
+    if (startOffset.QuadPart == cache->StreamNextOffset.QuadPart) {
+
+        if (cache->SequentialCount < DISK_READ_AHEAD_SEQUENTIAL_THRESHOLD) {
+            cache->SequentialCount++;
+        }
+
+    } else {
+
+        cache->SequentialCount = 0;
+    }
+
+    cache->StreamNextOffset = endOffset;
+
+    //
+    // Look for a valid window that holds the entire request.  Reads that
+    // must go to the media are never completed from the cache.
+    //
+
+    if (!TEST_FLAG(irpSp->Flags, SL_FORCE_ACCESS) && (Irp->MdlAddress != NULL)) {
+
+        for (i = 0; i < DISK_READ_AHEAD_WINDOWS; i++) {
+
+            window = &cache->Windows[i];
+
+            if ((window->State == DiskReadAheadValid) &&
+                (startOffset.QuadPart >= window->Offset.QuadPart) &&
+                (endOffset.QuadPart <= window->Offset.QuadPart + window->Length)) {
+
+                hitWindow = window;
+                break;
+            }
+        }
+    }
+
+    if (hitWindow != NULL) {
+
+        systemBuffer = MmGetSystemAddressForMdlSafe(Irp->MdlAddress, NormalPagePriority | MdlMappingNoExecute);
+
+        if (systemBuffer != NULL) {
+
+            RtlCopyMemory(systemBuffer,
+                          (PUCHAR)hitWindow->Buffer + (startOffset.QuadPart - hitWindow->Offset.QuadPart),
+                          length);
+
+            cache->ReadHits++;
+            cache->BytesHit += length;
+
+        } else {
+
+            hitWindow = NULL;
+        }
+    }
+
+    if (hitWindow == NULL) {
+        cache->ReadMisses++;
+    }
+
+    //
+    // Once a stream is established keep a window ahead of it: prefetch the
+    // data following the window that satisfied the read, or following the
+    // read itself, unless a window already holds or is fetching it.
+    //
+
+    if (cache->SequentialCount >= DISK_READ_AHEAD_SEQUENTIAL_THRESHOLD) {
+
+        if (hitWindow != NULL) {
+            prefetchOffset.QuadPart = hitWindow->Offset.QuadPart + hitWindow->Length;
+        } else {
+            prefetchOffset = endOffset;
+        }
+
+        for (i = 0; i < DISK_READ_AHEAD_WINDOWS; i++) {
+
+            window = &cache->Windows[i];
+
+            if (window->State == DiskReadAheadIdle) {
+
+                if (prefetchWindow == NULL) {
+                    prefetchWindow = window;
+                }
+
+            } else if ((prefetchOffset.QuadPart >= window->Offset.QuadPart) &&
+                       (prefetchOffset.QuadPart < window->Offset.QuadPart + window->Length)) {
+
+                //
+                // Already cached or being fetched.
+                //
+
+                prefetchWindow = NULL;
+                break;
+
+            } else if ((window->State == DiskReadAheadValid) &&
+                       (window != hitWindow) &&
+                       (window->Offset.QuadPart + window->Length <= startOffset.QuadPart)) {
+
+                //
+                // The stream has moved past this window, so it can be reused.
+                //
+
+                if (prefetchWindow == NULL) {
+                    prefetchWindow = window;
+                }
+            }
+        }
+
+        if ((prefetchWindow != NULL) &&
+            (prefetchOffset.QuadPart < commonExtension->PartitionLength.QuadPart)) {
+
+            bytesPerSector = commonExtension->PartitionZeroExtension->DiskGeometry.BytesPerSector;
+            bytesRemaining = commonExtension->PartitionLength.QuadPart - prefetchOffset.QuadPart;
+
+            prefetchWindow->Length = cache->WindowSize;
+
+            if (bytesRemaining < prefetchWindow->Length) {
+                prefetchWindow->Length = (ULONG)bytesRemaining & ~(bytesPerSector - 1);
+            }
+
+            if (prefetchWindow->Length != 0) {
+
+                prefetchWindow->State = DiskReadAheadPending;
+                prefetchWindow->Invalidated = FALSE;
+                prefetchWindow->Offset = prefetchOffset;
+
+                cache->Prefetches++;
+
+            } else {
+
+                prefetchWindow = NULL;
+            }
+
+        } else {
+
+            prefetchWindow = NULL;
+        }
+    }
+
+    KeReleaseSpinLock(&cache->Lock, oldIrql);
+
+    if (prefetchWindow != NULL) {
+        DiskReadAheadStartPrefetch(cache, prefetchWindow);
+    }
+
+    if (hitWindow != NULL) {
+
+        TracePrint((TRACE_LEVEL_VERBOSE, TRACE_FLAG_RW, "DiskReadAheadProcessRequest: Irp %p completed from the read-ahead cache\n", Irp));
+
+        //
+        // ClassReadWrite returns STATUS_PENDING for requests it no longer
+        // owns, so mark the irp pending before completing it.
+        //
+
+        IoMarkIrpPending(Irp);
+
+        Irp->IoStatus.Status = STATUS_SUCCESS;
+        Irp->IoStatus.Information = length;
+
+        ClassReleaseRemoveLock(DeviceObject, Irp);
+        ClassCompleteRequest(DeviceObject, Irp, IO_DISK_INCREMENT);
+
+        return TRUE;
+    }
+
+    return FALSE;
+
+} // end DiskReadAheadProcessRequest()
+
+
+VOID
+DiskReadAheadInvalidate(
+    IN PDEVICE_OBJECT DeviceObject
+    )
+
+/*++
+
+Routine Description:
+
+    This routine invalidates all the read-ahead windows of the device.  It is
+    used for requests other than writes that may change the media contents.
+
+Arguments:
+
+    DeviceObject - the device object
+
+Return Value:
+
+    none
+
+--*/
+
+{
+    PCOMMON_DEVICE_EXTENSION commonExtension = DeviceObject->DeviceExtension;
+    PDISK_DATA diskData = commonExtension->DriverData;
+    PDISK_READ_AHEAD_CACHE cache = &diskData->ReadAhead;
+    PDISK_READ_AHEAD_WINDOW window;
+    KIRQL oldIrql;
+    ULONG i;
+
+    if ((cache->WindowSize == 0) || !commonExtension->IsFdo) {
+        return;
+    }
+
+    KeAcquireSpinLock(&cache->Lock, &oldIrql);
+
+    for (i = 0; i < DISK_READ_AHEAD_WINDOWS; i++) {
+
+        window = &cache->Windows[i];
+
+        if (window->State == DiskReadAheadPending) {
+            window->Invalidated = TRUE;
+            cache->Invalidations++;
+        } else if (window->State == DiskReadAheadValid) {
+            window->State = DiskReadAheadIdle;
+            cache->Invalidations++;
+        }
+    }
+
+    cache->SequentialCount = 0;
+
+    KeReleaseSpinLock(&cache->Lock, oldIrql);
+
+    return;
+
+} // end DiskReadAheadInvalidate()
+
+
+VOID
+DiskReadAheadQueryStatistics(
+    IN PDEVICE_OBJECT DeviceObject,
+    OUT PDISK_READ_AHEAD_STATISTICS Statistics
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the read-ahead statistics of the device.
+
+Arguments:
+
+    DeviceObject - the device object
+
+    Statistics - receives the statistics
+
+Return Value:
+
+    none
+
+--*/
+
+{
+    PCOMMON_DEVICE_EXTENSION commonExtension = DeviceObject->DeviceExtension;
+    PDISK_DATA diskData = commonExtension->DriverData;
+    PDISK_READ_AHEAD_CACHE cache = &diskData->ReadAhead;
+    KIRQL oldIrql;
+
+    RtlZeroMemory(Statistics, sizeof(DISK_READ_AHEAD_STATISTICS));
+
+    if (cache->WindowSize == 0) {
+        return;
+    }
+
+    KeAcquireSpinLock(&cache->Lock, &oldIrql);
+
+    Statistics->WindowSize = cache->WindowSize;
+    Statistics->NumberOfWindows = DISK_READ_AHEAD_WINDOWS;
+    Statistics->ReadHits = cache->ReadHits;
+    Statistics->ReadMisses = cache->ReadMisses;
+    Statistics->BytesHit = cache->BytesHit;
+    Statistics->Prefetches = cache->Prefetches;
+    Statistics->Invalidations = cache->Invalidations;
+
+    KeReleaseSpinLock(&cache->Lock, oldIrql);
+
+    return;
+
+} // end DiskReadAheadQueryStatistics()
+
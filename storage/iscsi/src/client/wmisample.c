@@ -114,6 +114,12 @@ iSpSetTCPConfigInfo(
     IN PUCHAR Buffer
     );
 
+BOOLEAN
+iSpGetInstanceNameSessionID(
+    IN PWMIString InstanceName,
+    OUT PULONG DisplaySessionID
+    );
+
 UCHAR
 iScsiSetWmiDataBlock(
     IN PVOID Context,
@@ -1703,6 +1709,8 @@ iSpBuildConnectionStatistics(
         ULONG sessionInx;
         ULONG connectionInx;
         ULONG connectionCount;
+        ULONG requestedSessionID = 0;
+        BOOLEAN sessionIDValid;
         BOOLEAN found = FALSE;
 
         //
@@ -1720,6 +1728,9 @@ iSpBuildConnectionStatistics(
         {
             givenInstanceNameLength = instanceName->Length / sizeof(instanceName->Buffer[0]);
 
+            sessionIDValid = iSpGetInstanceNameSessionID(instanceName,
+                                                         &requestedSessionID);
+
             *SizeNeeded = sizeof(MSiSCSI_ConnectionStatistics);
             if (BufferAvail < *SizeNeeded)
             {
@@ -1736,12 +1747,20 @@ iSpBuildConnectionStatistics(
 
                 while (sessionInx < numberOfSessions) {
 
-                    if (connectionList[sessionInx].Count) {
+                    //
+                    // Only the session named in the instance can hold the
+                    // connection, so skip the others without formatting
+                    // their names.
+                    //
+                    if ((connectionList[sessionInx].Count > 0) &&
+                        (connectionList[sessionInx].ISCSIConnection[0] != NULL) &&
+                        (!sessionIDValid ||
+                         (connectionList[sessionInx].ISCSIConnection[0]->ISCSISession->DisplaySessionID == requestedSessionID))) {
 
                         connectionInx = 0;
 
-                        while (connectionInx < numberOfConnections) {
-                            iScsiConnection = connectionList[sessionInx].ISCSIConnection[0];
+                        while (connectionInx < connectionList[sessionInx].Count) {
+                            iScsiConnection = connectionList[sessionInx].ISCSIConnection[connectionInx];
 
                             if (iScsiConnection != NULL) {
 
@@ -2000,6 +2019,8 @@ iSpBuildSessionStatistics(
         ULONG dynInstanceNameLength = 0;
         ULONG instanceNameLength;
         ULONG sessionInx;
+        ULONG requestedSessionID = 0;
+        BOOLEAN sessionIDValid;
         BOOLEAN found = FALSE;
 
         srbStatus = SRB_STATUS_ERROR;
@@ -2013,6 +2034,9 @@ iSpBuildSessionStatistics(
         {
             givenInstanceNameLength = instanceName->Length / sizeof(instanceName->Buffer[0]);
 
+            sessionIDValid = iSpGetInstanceNameSessionID(instanceName,
+                                                         &requestedSessionID);
+
             *SizeNeeded = sizeof(MSiSCSI_SessionStatistics);
             if (BufferAvail < *SizeNeeded)
             {
@@ -2028,7 +2052,14 @@ iSpBuildSessionStatistics(
                     PISCSI_SESSION iScsiSession;
                     PISCSI_CONNECTION iScsiConnection;
 
-                    if (connectionList[sessionInx].Count > 0) {
+                    //
+                    // Compare the display session ID before formatting the
+                    // full instance name of every session.
+                    //
+                    if ((connectionList[sessionInx].Count > 0) &&
+                        (connectionList[sessionInx].ISCSIConnection[0] != NULL) &&
+                        (!sessionIDValid ||
+                         (connectionList[sessionInx].ISCSIConnection[0]->ISCSISession->DisplaySessionID == requestedSessionID))) {
 
                         iScsiConnection = connectionList[sessionInx].ISCSIConnection[0];
                         iScsiSession = iScsiConnection->ISCSISession;
@@ -2074,6 +2105,9 @@ iSpBuildSessionStatistics(
         }
     }
 
+    iSpReleaseConnectionReferences(connectionList,
+                                   numberOfSessions);
+
 
     return srbStatus;
 }
@@ -2271,6 +2305,8 @@ iSpBuildRequestTimeStatistics(
         ULONG sessionInx;
         ULONG connectionInx;
         ULONG connectionCount;
+        ULONG requestedSessionID = 0;
+        BOOLEAN sessionIDValid;
         BOOLEAN found = FALSE;
 
         //
@@ -2288,6 +2324,9 @@ iSpBuildRequestTimeStatistics(
         {
             givenInstanceNameLength = instanceName->Length / sizeof(instanceName->Buffer[0]);
 
+            sessionIDValid = iSpGetInstanceNameSessionID(instanceName,
+                                                         &requestedSessionID);
+
             *SizeNeeded = sizeof(MSiSCSI_RequestTimeStatistics);
             if (BufferAvail < *SizeNeeded)
             {
@@ -2304,12 +2343,20 @@ iSpBuildRequestTimeStatistics(
 
                 while (sessionInx < numberOfSessions) {
 
-                    if (connectionList[sessionInx].Count) {
+                    //
+                    // Only the session named in the instance can hold the
+                    // connection, so skip the others without formatting
+                    // their names.
+                    //
+                    if ((connectionList[sessionInx].Count > 0) &&
+                        (connectionList[sessionInx].ISCSIConnection[0] != NULL) &&
+                        (!sessionIDValid ||
+                         (connectionList[sessionInx].ISCSIConnection[0]->ISCSISession->DisplaySessionID == requestedSessionID))) {
 
                         connectionInx = 0;
 
-                        while (connectionInx < numberOfConnections) {
-                            iScsiConnection = connectionList[sessionInx].ISCSIConnection[0];
+                        while (connectionInx < connectionList[sessionInx].Count) {
+                            iScsiConnection = connectionList[sessionInx].ISCSIConnection[connectionInx];
 
                             if (iScsiConnection != NULL) {
 
@@ -5939,6 +5986,78 @@ Return Value:
 }
 
 
+BOOLEAN
+iSpGetInstanceNameSessionID(
+    IN PWMIString InstanceName,
+    OUT PULONG DisplaySessionID
+    )
+/*++
+
+Routine Description:
+
+   Extract the display session ID from a session ("targetname_#") or
+    connection ("targetname_#:#") instance name, so that single instance
+    queries only need to format the name of the session it refers to.
+
+Arguments:
+
+   InstanceName - The instance name given in the query.
+
+   DisplaySessionID - On return contains the display session ID.
+
+Return Value:
+
+   TRUE if the name ends in a display session ID, FALSE otherwise. The
+    caller must then compare the full name with every session.
+
+--*/
+{
+    ULONG nameLength;
+    ULONG inx;
+    ULONG sessionID = 0;
+    ULONG digits = 0;
+
+    nameLength = InstanceName->Length / sizeof(InstanceName->Buffer[0]);
+    if (nameLength > MAX_UNICODE_STR_LENGTH) {
+        return FALSE;
+    }
+
+    //
+    // Find the separator in front of the display session ID. Target names
+    // may contain '_' themselves, so search backwards.
+    //
+    inx = nameLength;
+    while ((inx > 0) && (InstanceName->Buffer[inx - 1] != L'_')) {
+        inx--;
+    }
+
+    if (inx == 0) {
+        return FALSE;
+    }
+
+    while ((inx < nameLength) && (InstanceName->Buffer[inx] != L':')) {
+
+        if ((InstanceName->Buffer[inx] < L'0') ||
+            (InstanceName->Buffer[inx] > L'9') ||
+            (sessionID > (MAXULONG - 9) / 10)) {
+            return FALSE;
+        }
+
+        sessionID = (sessionID * 10) + (InstanceName->Buffer[inx] - L'0');
+        digits++;
+        inx++;
+    }
+
+    if (digits == 0) {
+        return FALSE;
+    }
+
+    *DisplaySessionID = sessionID;
+
+    return TRUE;
+}
+
+
 VOID
 iScsiFireAdapterEvent(
     PISCSI_ADAPTER_EXTENSION AdapterExtension,
@@ -74,6 +74,7 @@ typedef struct _SRB_EXTENSION {
     PSVARS_DESCRIPTOR_TABLE svdt;               // pointer to this svdt
     SVARS_DESCRIPTOR_TABLE svarsDescriptorTable; // descriptor table
     UCHAR AlignPad[4];
+    BOOLEAN templateHit;                        // svdt built from template
 
 }SRB_EXTENSION, *PSRB_EXTENSION;
 
@@ -81,6 +82,35 @@ typedef struct _SRB_EXTENSION {
 #define SRB_EXT(x) ((PSRB_EXTENSION)(x->SrbExtension))
 
 
+//
+// Define the per-LUN command templates.  BuildIo saves the svdt header
+// (table descriptors, CDB area and message out bytes) of the commands it
+// builds, so a command with the same shape as a recent one on the LUN is
+// set up with a single copy.  Only commands without negotiations use them.
+//
+
+#define CMD_TEMPLATES_PER_LUN   2       // command shapes kept for each LUN
+#define CMD_TEMPLATE_VALID      0x01000000L // set in shape of a used entry
+#define CMD_TEMPLATE_SRB_FLAGS  (SRB_FLAGS_QUEUE_ACTION_ENABLE | \
+                                 SRB_FLAGS_DISABLE_DISCONNECT)
+
+// size of the svdt area from deviceDescriptor up to nexusEntryPhys
+#define CMD_TEMPLATE_HDR_SIZE   (FIELD_OFFSET(SVARS_DESCRIPTOR_TABLE, nexusEntryPhys) - \
+                                 FIELD_OFFSET(SVARS_DESCRIPTOR_TABLE, deviceDescriptor))
+
+typedef struct _CMD_TEMPLATE {
+    ULONG shape;                        // CDB length, SRB flags, queue action
+    ULONG dxp;                          // data xfer parms the header uses
+    UCHAR header[CMD_TEMPLATE_HDR_SIZE]; // svdt header of the command
+} CMD_TEMPLATE, *PCMD_TEMPLATE;
+
+typedef struct _LU_CMD_TEMPLATES {
+    volatile LONG lock;                 // BuildIo try-lock, 0 = free
+    ULONG next;                         // entry to replace on next miss
+    CMD_TEMPLATE entry[CMD_TEMPLATES_PER_LUN];
+} LU_CMD_TEMPLATES, *PLU_CMD_TEMPLATES;
+
+
 
 // Define the noncached extension.  Data items are placed in the noncached
 // extension because they are accessed via DMA.
@@ -219,6 +249,12 @@ typedef struct _HW_DEVICE_EXTENSION {
 // DMI data structure
     DMI_DATA DmiData;           // DMI (CIM) data for IOCTL
 
+// I/O statistics structure
+    IO_STATISTICS IoStats;      // command/interrupt counters for IOCTL
+
+// command templates, indexed like the ITL nexus table (target * 16 + lun)
+    LU_CMD_TEMPLATES LuCmdTemplates[256];
+
 } HW_DEVICE_EXTENSION, *PHW_DEVICE_EXTENSION;
 
 // predefined message buffers for wide/sync negotiation messages
@@ -488,6 +524,20 @@ ScatterGatherScriptSetup(
     IN BOOLEAN hostSvdt
     );
 
+BOOLEAN
+GetCmdTemplate(
+    IN PHW_DEVICE_EXTENSION DeviceExtension,
+    IN PSCSI_REQUEST_BLOCK Srb,
+    IN PSVARS_DESCRIPTOR_TABLE svdtPtr
+    );
+
+VOID
+SaveCmdTemplate(
+    IN PHW_DEVICE_EXTENSION DeviceExtension,
+    IN PSCSI_REQUEST_BLOCK Srb,
+    IN PSVARS_DESCRIPTOR_TABLE svdtPtr
+    );
+
 VOID
 SetChipModes (
     IN PHW_DEVICE_EXTENSION DeviceExtension
@@ -2056,6 +2106,8 @@ Return Value:
         DebugPrint((3, "LsiU3(%2x) LsiU3ISR: interrupt Fly --\n ",
             DeviceExtension->SIOPRegisterBase ));
 
+        DeviceExtension->IoStats.IntFlyCount++;
+
         // Scan completion queue, processing all completed commands.
         doneQRemove(DeviceExtension, IntStatus);
         return(TRUE);
@@ -2068,6 +2120,7 @@ Return Value:
         ScsiStatus1 = READ_SIOP_UCHAR(SIST1);
         if ( ScsiStatus & SSTAT0_PHASE_MISMATCH )
         {
+            DeviceExtension->IoStats.OtherIntCount++;
             ISRDisposition = ProcessPhaseMismatch(DeviceExtension);
             if ( ISRDisposition == ISR_RESTART_SCRIPT )
                 WRITE_SIOP_ULONG( DSP, DeviceExtension->RestartScriptPhys);
@@ -2175,6 +2228,8 @@ Return Value:
         DeviceExtension->SIOPRegisterBase,
         IntStatus, DmaStatus, ScsiStatus, ScsiStatus1));
          
+    DeviceExtension->IoStats.OtherIntCount++;
+
     ISR_Service_Next(DeviceExtension,ISRDisposition);
     
     return(TRUE);
@@ -2367,52 +2422,86 @@ Return Value:
     svdtPtr->runningByteCount = 0;  // initialize total byte count
     svdtPtr->sysSvdtPhys = svdtPAdd;        // phys ptr to svdt is sys mem
     svdtPtr->iovPhys = DeviceExtension->localIovPhys;   // iovPhys address
-    // copy CDB into svdt
-    StorPortMoveMemory(svdtPtr->Cdb, Srb->Cdb, Srb->CdbLength);
-    // copy table descriptor templates into svdt
-    StorPortMoveMemory( &svdtPtr->deviceDescriptor,
-                        &DeviceExtension->deviceDesc, 24);
-    // update table descriptor entries
-    svdtPtr->deviceDescriptor.count = DeviceExtension->dxp[target];
-    svdtPtr->cmdBufDescriptor.count = Srb->CdbLength;   // set CDB length
 
     // Clear auto request sense flag
     SrbExtension->autoReqSns = 0;
-    
-    // If there is data to transfer set up scatter/gather.
-    if ( (srbFlgs = Srb->SrbFlags) & SRB_FLAGS_UNSPECIFIED_DIRECTION)
-        iovLen = ScatterGatherScriptSetup( DeviceExtension, Srb, TRUE);
-
-    // build Scripts command to move svdt
-    svdtMove = MEMORY_MOVE_CMD +
-        FIELD_OFFSET(SVARS_DESCRIPTOR_TABLE, iovList) + iovLen;
-    svdtPtr->svdtMoveCmd = svdtMove;        // mem move command + len
-
-    // Set up the identify message.  If disconnect is disabled reset DSCPRV.
-    msg0 = (UCHAR) SCSIMESS_IDENTIFY_WITH_DISCON + lun;
-    if ( srbFlgs & SRB_FLAGS_DISABLE_DISCONNECT) 
-    {
-        msg0 &= ~SCSIMESS_IDENTIFY_DISC_PRIV_MASK;
-    } // if
-    svdtPtr->msgOutBuf[0] = msg0;
 
     SrbExtension->SrbExtFlags = 0;  // clear negotiation flags
 
-    MessageCount = 1;
+    srbFlgs = Srb->SrbFlags;
 
     DebugPrint((3, "LsiU3(%2x) LsiU3BuildIo: Building request for Id=%2x  Lun=%2x \n",
         DeviceExtension->SIOPRegisterBase,
         Srb->TargetId,
         Srb->Lun ));
 
+    // Use the svdt header of a recent command of the same shape on this
+    // LUN if there is one, otherwise build it and save it as a template.
+    SrbExtension->templateHit = GetCmdTemplate(DeviceExtension, Srb, svdtPtr);
+    if ( !SrbExtension->templateHit )
+    {
+        // copy table descriptor templates into svdt
+        StorPortMoveMemory( &svdtPtr->deviceDescriptor,
+                            &DeviceExtension->deviceDesc, 24);
+        // update table descriptor entries
+        svdtPtr->deviceDescriptor.count = DeviceExtension->dxp[target];
+        svdtPtr->cmdBufDescriptor.count = Srb->CdbLength;   // set CDB length
+
+        // Set up the identify message.  If disconnect is disabled reset DSCPRV.
+        msg0 = (UCHAR) SCSIMESS_IDENTIFY_WITH_DISCON + lun;
+        if ( srbFlgs & SRB_FLAGS_DISABLE_DISCONNECT) 
+        {
+            msg0 &= ~SCSIMESS_IDENTIFY_DISC_PRIV_MASK;
+        } // if
+        svdtPtr->msgOutBuf[0] = msg0;
+
+        MessageCount = 1;
+
+        if (srbFlgs & SRB_FLAGS_QUEUE_ACTION_ENABLE)
+        {
+            // The queue tag message is two bytes the first is the queue action
+            // and the second is the queue tag.  However, we must use a driver
+            // assigned queue tag (index into start queue), so that can't be
+            // determined until the StartSCSIRequest (StartIo) routine.
+            svdtPtr->msgOutBuf[1] = Srb->QueueAction;
+            MessageCount = 3;
+        }
+
+        // Check to see if negotiations are needed.  Always negotiate on
+        // an OS issued Request Sense command
+        if ( (DeviceExtension->LuFlags[target] & LF_NEG_NEEDED) ||
+             (Srb->Cdb[0] == SCSIOP_REQUEST_SENSE) )
+        {
+            MessageCount = StartNegotiations(DeviceExtension, Srb, MessageCount,
+                                             TRUE);
+        }
+        
+        // indicate message length
+        svdtPtr->msgOutBufDescriptor.count = (ULONG)MessageCount;
+
+        // save the header for the next command of this shape
+        SaveCmdTemplate(DeviceExtension, Srb, svdtPtr);
+    }
+
+    // copy CDB into svdt
+    StorPortMoveMemory(svdtPtr->Cdb, Srb->Cdb, Srb->CdbLength);
+
+    DebugPrint((3, " CDB = %2x %2x %2x %2x %2x %2x %2x %2x %2x %2x %2x %2x \n",
+        Srb->Cdb[0], Srb->Cdb[1], Srb->Cdb[2], Srb->Cdb[3],
+        Srb->Cdb[4], Srb->Cdb[5], Srb->Cdb[6], Srb->Cdb[7],
+        Srb->Cdb[8], Srb->Cdb[9], Srb->Cdb[10], Srb->Cdb[11] ));
+
+    // If there is data to transfer set up scatter/gather.
+    if ( srbFlgs & SRB_FLAGS_UNSPECIFIED_DIRECTION)
+        iovLen = ScatterGatherScriptSetup( DeviceExtension, Srb, TRUE);
+
+    // build Scripts command to move svdt
+    svdtMove = MEMORY_MOVE_CMD +
+        FIELD_OFFSET(SVARS_DESCRIPTOR_TABLE, iovList) + iovLen;
+    svdtPtr->svdtMoveCmd = svdtMove;        // mem move command + len
+
     if (srbFlgs & SRB_FLAGS_QUEUE_ACTION_ENABLE)
     {
-        // The queue tag message is two bytes the first is the queue action
-        // and the second is the queue tag.  However, we must use a driver
-        // assigned queue tag (index into start queue), so that can't be
-        // determined until the StartSCSIRequest (StartIo) routine.
-        svdtPtr->msgOutBuf[1] = Srb->QueueAction;
-        MessageCount = 3;
         DebugPrint((3, "LsiU3(%2x) Tagged I/O request \n",
             DeviceExtension->SIOPRegisterBase));
     }
@@ -2428,23 +2517,6 @@ Return Value:
             DeviceExtension->SIOPRegisterBase));
     }
 
-    DebugPrint((3, " CDB = %2x %2x %2x %2x %2x %2x %2x %2x %2x %2x %2x %2x \n",
-        Srb->Cdb[0], Srb->Cdb[1], Srb->Cdb[2], Srb->Cdb[3],
-        Srb->Cdb[4], Srb->Cdb[5], Srb->Cdb[6], Srb->Cdb[7],
-        Srb->Cdb[8], Srb->Cdb[9], Srb->Cdb[10], Srb->Cdb[11] ));
-
-    // Check to see if negotiations are needed.  Always negotiate on
-    // an OS issued Request Sense command
-    if ( (DeviceExtension->LuFlags[target] & LF_NEG_NEEDED) ||
-         (Srb->Cdb[0] == SCSIOP_REQUEST_SENSE) )
-    {
-        MessageCount = StartNegotiations(DeviceExtension, Srb, MessageCount,
-                                         TRUE);
-    }
-    
-    // indicate message length
-    svdtPtr->msgOutBufDescriptor.count = (ULONG)MessageCount;
-
     // ready for StartIo, return TRUE
     return(TRUE);
 
@@ -2607,6 +2679,22 @@ Return Value:
                 DeviceExtension->DmiData.HotSwap = FALSE;
             }
         }
+        else if ( pSic->ControlCode == STATS_GET_DATA && p[0] == '4' &&
+                  p[1] == '.' && p[2] == '0' )
+        {
+            if (pSic->Length < sizeof(DeviceExtension->IoStats))
+            {
+                DebugPrint((1,"IO_Control buffer too small"));
+                Srb->SrbStatus = SRB_STATUS_INVALID_REQUEST;
+            }
+            else
+            {
+                // copy IoStats structure to SIC buffer
+                StorPortMoveMemory(((PSRB_BUFFER)(Srb->DataBuffer))->ucDataBuffer, &DeviceExtension->IoStats, sizeof(DeviceExtension->IoStats));
+                pSic->Length = sizeof(DeviceExtension->IoStats);
+                Srb->SrbStatus = SRB_STATUS_SUCCESS;
+            }
+        }
         else if ( pSic->ControlCode == NVCONFIG_IOCTL && p[1] == '4' &&
                   p[2] == '0' && p[3] == '0' )
         {
@@ -5750,7 +5838,7 @@ Return Value:
     ULONG ElementLength;
     ULONG_PTR iovStart;
     PSRB_EXTENSION SrbExtension = Srb->SrbExtension;
-    PULONG iovPtr, iovSR;
+    PULONG iovPtr, iovSR, lastMove;
     PSTOR_SCATTER_GATHER_LIST pSpSGStruct;
     PSTOR_SCATTER_GATHER_ELEMENT pSpSGL;
 
@@ -5785,30 +5873,38 @@ Return Value:
     numElements = pSpSGStruct->NumberOfElements;
     pSpSGL = pSpSGStruct->List;
 
-    // build the SG move instructions
-    for ( loop = 1; loop <= numElements; loop++ )
+    // build the SG move instructions, one loop for each address size so
+    // the per-element work is just the stores
+    lastMove = iovPtr;
+    if (do64bit)
     {
-        ElementLength = pSpSGL->Length;
-        // for data out, last element needs to be a MOVE instead of a CHMOV
-        // for data in, all elements must be a CHMOV (1010 errata)
-        if ( (loop == numElements) && !dataIn )
+        for ( loop = 0; loop < numElements; loop++, pSpSGL++ )
         {
-            *iovPtr++ = scriptCmd | MOVE_CMD_SCRIPT | ElementLength;
+            lastMove = iovPtr;
+            ElementLength = pSpSGL->Length;
+            *iovPtr++ = scriptCmd | ElementLength;
+            // low 32-bits, then high 32-bits of physical address
+            *iovPtr++ = pSpSGL->PhysicalAddress.LowPart;
+            *iovPtr++ = pSpSGL->PhysicalAddress.HighPart;
         }
-        else
+    }
+    else
+    {
+        for ( loop = 0; loop < numElements; loop++, pSpSGL++ )
         {
+            lastMove = iovPtr;
+            ElementLength = pSpSGL->Length;
             *iovPtr++ = scriptCmd | ElementLength;
+            // next dword is low 32-bits of physical address
+            *iovPtr++ = pSpSGL->PhysicalAddress.LowPart;
         }
+    }
 
-        // next dword is low 32-bits of physical address
-        *iovPtr++ = pSpSGL->PhysicalAddress.LowPart;
-
-        // if using 64-bit addresses, next dword is high 32-bits
-        if (do64bit)
-            *iovPtr++ = pSpSGL->PhysicalAddress.HighPart;
-
-        // bump SGL pointer
-        pSpSGL++;
+    // for data out, last element needs to be a MOVE instead of a CHMOV
+    // for data in, all elements must be a CHMOV (1010 errata)
+    if ( numElements && !dataIn )
+    {
+        *lastMove |= MOVE_CMD_SCRIPT;
     }
 
     // if using 64-bit addresses, insert instruction to turn off 64-bit mode
@@ -5845,6 +5941,146 @@ Return Value:
 } // ScatterGatherScriptSetup
 
 
+BOOLEAN
+GetCmdTemplate(
+    IN PHW_DEVICE_EXTENSION DeviceExtension,
+    IN PSCSI_REQUEST_BLOCK Srb,
+    IN PSVARS_DESCRIPTOR_TABLE svdtPtr
+    )
+/*++
+
+Routine Description:
+
+    This routine looks for a command template with the same shape as this
+    request on its LUN.  If there is one, the saved svdt header (table
+    descriptors and message out bytes) is copied into the svdt.
+
+    NOTE:  BuildIo runs without locks, so the templates of a LUN are guarded
+    by a try-lock.  If another BuildIo owns the lock, the command is simply
+    built without a template.
+
+Arguments:
+
+    DeviceExtension - Supplies the device Extension for the SCSI bus adapter.
+
+    Srb - Supplies the Srb pointer for this I/O.
+
+    svdtPtr - Supplies the svdt of this I/O in the SrbExtension.
+
+Return Value:
+
+    TRUE - the svdt header was copied from a template.
+
+    FALSE - no template for this command, the svdt header must be built.
+
+--*/
+
+{
+    UCHAR target = Srb->TargetId;
+    ULONG shape, dxp, i;
+    BOOLEAN hit = FALSE;
+    PLU_CMD_TEMPLATES templates;
+    PCMD_TEMPLATE pTemplate;
+
+    // negotiations build special message out bytes, never use a template
+    if ( (DeviceExtension->LuFlags[target] & LF_NEG_NEEDED) ||
+         (Srb->Cdb[0] == SCSIOP_REQUEST_SENSE) )
+    {
+        return(FALSE);
+    }
+
+    templates = &DeviceExtension->LuCmdTemplates[(target * 16) + Srb->Lun];
+    if ( InterlockedCompareExchange(&templates->lock, 1, 0) != 0 )
+    {
+        return(FALSE);
+    }
+
+    shape = CMD_TEMPLATE_VALID + (Srb->QueueAction << 16) +
+        ((Srb->SrbFlags & CMD_TEMPLATE_SRB_FLAGS) << 8) + Srb->CdbLength;
+    dxp = DeviceExtension->dxp[target];
+
+    for ( i = 0; i < CMD_TEMPLATES_PER_LUN; i++ )
+    {
+        pTemplate = &templates->entry[i];
+        if ( (pTemplate->shape == shape) && (pTemplate->dxp == dxp) )
+        {
+            StorPortMoveMemory( &svdtPtr->deviceDescriptor,
+                                pTemplate->header, CMD_TEMPLATE_HDR_SIZE);
+            // replace the other entry on the next miss
+            templates->next = (i + 1) % CMD_TEMPLATES_PER_LUN;
+            hit = TRUE;
+            break;
+        }
+    }
+
+    InterlockedExchange(&templates->lock, 0);
+
+    return(hit);
+
+} // GetCmdTemplate
+
+
+VOID
+SaveCmdTemplate(
+    IN PHW_DEVICE_EXTENSION DeviceExtension,
+    IN PSCSI_REQUEST_BLOCK Srb,
+    IN PSVARS_DESCRIPTOR_TABLE svdtPtr
+    )
+/*++
+
+Routine Description:
+
+    This routine saves the svdt header just built for this request as the
+    command template for its shape, replacing the least recently used
+    template of the LUN.  Commands doing negotiations are not saved.
+
+Arguments:
+
+    DeviceExtension - Supplies the device Extension for the SCSI bus adapter.
+
+    Srb - Supplies the Srb pointer for this I/O.
+
+    svdtPtr - Supplies the svdt of this I/O in the SrbExtension.
+
+Return Value:
+
+    None
+
+--*/
+
+{
+    UCHAR target = Srb->TargetId;
+    PLU_CMD_TEMPLATES templates;
+    PCMD_TEMPLATE pTemplate;
+
+    // header has negotiation messages, or SrbExtFlags were set for them
+    if ( (DeviceExtension->LuFlags[target] & LF_NEG_NEEDED) ||
+         (Srb->Cdb[0] == SCSIOP_REQUEST_SENSE) ||
+         SRB_EXT(Srb)->SrbExtFlags )
+    {
+        return;
+    }
+
+    templates = &DeviceExtension->LuCmdTemplates[(target * 16) + Srb->Lun];
+    if ( InterlockedCompareExchange(&templates->lock, 1, 0) != 0 )
+    {
+        return;
+    }
+
+    pTemplate = &templates->entry[templates->next];
+    templates->next = (templates->next + 1) % CMD_TEMPLATES_PER_LUN;
+
+    pTemplate->shape = CMD_TEMPLATE_VALID + (Srb->QueueAction << 16) +
+        ((Srb->SrbFlags & CMD_TEMPLATE_SRB_FLAGS) << 8) + Srb->CdbLength;
+    pTemplate->dxp = svdtPtr->deviceDescriptor.count;
+    StorPortMoveMemory( pTemplate->header,
+                        &svdtPtr->deviceDescriptor, CMD_TEMPLATE_HDR_SIZE);
+
+    InterlockedExchange(&templates->lock, 0);
+
+} // SaveCmdTemplate
+
+
 VOID
 SetChipModes (
     IN PHW_DEVICE_EXTENSION DeviceExtension
@@ -6948,6 +7184,11 @@ Return Value:
 
     WRITE_SIOP_UCHAR(ISTAT0, ISTAT_SIGP);
 
+    // update start statistics
+    DeviceExtension->IoStats.CommandsStarted++;
+    if ( SrbExtension->templateHit )
+        DeviceExtension->IoStats.TemplateHits++;
+
     index++;
     if (index == START_Q_DEPTH)
     {
@@ -7012,7 +7253,7 @@ Return Value:
 --*/
 
 {
-    ULONG index, statLen;
+    ULONG index, statLen, doneCount = 0;
 #ifdef _WIN64
     STOR_PHYSICAL_ADDRESS svdtPhys;
     PSVARS_DESCRIPTOR_TABLE svdtPtr;
@@ -7062,6 +7303,7 @@ Return Value:
 
         // clear queue entry
         DeviceExtension->ioDoneQueue[index].context = 0;
+        doneCount++;
 
         index++;
         if (index == DONE_Q_DEPTH)
@@ -7083,6 +7325,11 @@ Return Value:
     // Save local copy of index into ioDoneQIndex
     DeviceExtension->ioDoneQIndex = index;
 
+    // update completion statistics
+    DeviceExtension->IoStats.CommandsCompleted += doneCount;
+    if ( doneCount > DeviceExtension->IoStats.MaxDonePerIntFly )
+        DeviceExtension->IoStats.MaxDonePerIntFly = doneCount;
+
 } // doneQRemove
 
 
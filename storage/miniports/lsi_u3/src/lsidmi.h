@@ -45,6 +45,7 @@ Revision History:
 // bit 31 of this code must be on to denote it is a user-defined code
 #define DMI_GET_DATA    0x80444D49      // last 3 bytes are 'DMI'
 #define NVCONFIG_IOCTL  0x804E5643      // last 3 bytes are 'NVC'
+#define STATS_GET_DATA  0x80535441      // last 3 bytes are 'STA'
 
 // DMI data structure for retrieval by IOCTL function
 // Original structure is version 4.00 (IOCTL Signature)
@@ -65,6 +66,19 @@ typedef struct _DMI_DATA
     BOOLEAN HotSwap;                    // TRUE if hot swap has occurred
 } DMI_DATA, *PDMI_DATA;
 
+// I/O statistics structure for retrieval by IOCTL function
+// Commands issued per interrupt is CommandsStarted divided by the sum of
+// IntFlyCount and OtherIntCount.
+typedef struct _IO_STATISTICS
+{
+    ULONG CommandsStarted;              // commands put on the start queue
+    ULONG CommandsCompleted;            // commands taken off the done queue
+    ULONG IntFlyCount;                  // interrupt-on-the-fly interrupts
+    ULONG OtherIntCount;                // all other interrupts serviced
+    ULONG MaxDonePerIntFly;             // most completions for one IntFly
+    ULONG TemplateHits;                 // commands built from a template
+} IO_STATISTICS, *PIO_STATISTICS;
+
 // SrbBuffer structure to handle IO_Control call
 typedef struct {
     SRB_IO_CONTROL sic;
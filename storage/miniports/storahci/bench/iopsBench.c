@@ -0,0 +1,525 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All Rights Reserved
+
+Module Name:
+
+    iopsBench.c
+
+Abstract:
+
+    A 4K random read benchmark for disks behind StorAHCI.
+
+    StorAHCI asks StorPort to run the completion DPC on the processor that
+    issued the request, unless the DisableDpcRedirectionCurrentCpu value
+    of its Parameters\Device key is set.  The setting is read when the
+    adapter starts, so the benchmark runs with whatever setting the
+    adapter was started with and prints it; compare a run with the value
+    at 0 and a run with it at 1, restarting the controller in between.
+
+    One thread runs on each processor.  It opens every disk itself, with
+    its own completion port, and keeps QueueDepth unbuffered 4K reads at
+    random aligned offsets outstanding on each, so that every request is
+    issued and its completion processed on the same processor.  The
+    benchmark prints the reads per second, the average latency, and the
+    processor time spent per read, which is where completing on the
+    issuing processor shows first when the disks themselves are the limit.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_code_)
+
+#include <windows.h>
+#include <winioctl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define DEFAULT_MILLISECONDS    10000
+#define DEFAULT_QUEUE_DEPTH     32
+
+#define READ_SIZE               4096
+#define MAX_DISKS               32
+#define MAX_QUEUE_DEPTH         256
+
+#define STORAHCI_DEVICE_PARAMETERS_KEY  L"SYSTEM\\CurrentControlSet\\Services\\storahci\\Parameters\\Device"
+#define STORAHCI_CURRENT_CPU_VALUE      L"DisableDpcRedirectionCurrentCpu"
+
+typedef struct _BENCH_READ {
+
+    OVERLAPPED Overlapped;
+    ULONG Disk;
+    PUCHAR Buffer;
+    LARGE_INTEGER Issued;
+
+} BENCH_READ, *PBENCH_READ;
+
+typedef struct _BENCH_THREAD {
+
+    HANDLE Thread;
+    ULONG Processor;
+    ULONGLONG Seed;
+    HANDLE CompletionPort;
+    HANDLE Disks[MAX_DISKS];
+    PBENCH_READ Reads;
+    PUCHAR Buffers;
+
+    ULONGLONG Completed;
+    ULONGLONG Failed;
+    LONGLONG Latency;
+
+} BENCH_THREAD, *PBENCH_THREAD;
+
+ULONG DiskNumbers[MAX_DISKS];
+ULONGLONG DiskBlocks[MAX_DISKS];
+ULONG DiskCount;
+
+ULONG QueueDepth = DEFAULT_QUEUE_DEPTH;
+
+LARGE_INTEGER Frequency;
+LARGE_INTEGER Deadline;
+
+
+ULONGLONG
+FileTimeValue (
+    _In_ const FILETIME *Time
+    )
+{
+    return ((ULONGLONG)Time->dwHighDateTime << 32) | Time->dwLowDateTime;
+}
+
+
+HANDLE
+OpenDisk (
+    _In_ ULONG DiskNumber
+    )
+{
+    WCHAR Name[32];
+
+    swprintf_s( Name, ARRAYSIZE( Name ), L"\\\\.\\PhysicalDrive%u", DiskNumber );
+
+    return CreateFileW( Name,
+                        GENERIC_READ,
+                        FILE_SHARE_READ | FILE_SHARE_WRITE,
+                        NULL,
+                        OPEN_EXISTING,
+                        FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED,
+                        NULL );
+}
+
+
+BOOL
+IssueRead (
+    _Inout_ PBENCH_THREAD Thread,
+    _Inout_ PBENCH_READ Read
+    )
+
+/*++
+
+Routine Description:
+
+    Starts a read of a random READ_SIZE block of the disk of Read.
+
+--*/
+
+{
+    ULONGLONG Offset;
+
+    Thread->Seed = Thread->Seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    Offset = ((Thread->Seed >> 16) % DiskBlocks[Read->Disk]) * READ_SIZE;
+
+    ZeroMemory( &Read->Overlapped, sizeof( Read->Overlapped ) );
+    Read->Overlapped.Offset = (DWORD)Offset;
+    Read->Overlapped.OffsetHigh = (DWORD)(Offset >> 32);
+
+    QueryPerformanceCounter( &Read->Issued );
+
+    if (!ReadFile( Thread->Disks[Read->Disk], Read->Buffer, READ_SIZE, NULL, &Read->Overlapped ) &&
+        (GetLastError() != ERROR_IO_PENDING)) {
+
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+DWORD
+WINAPI
+BenchThread (
+    _In_ LPVOID Context
+    )
+
+/*++
+
+Routine Description:
+
+    Keeps QueueDepth reads outstanding on every disk until the deadline,
+    then waits for the last of them.
+
+--*/
+
+{
+    PBENCH_THREAD Thread = Context;
+    PBENCH_READ Read;
+    LPOVERLAPPED Overlapped;
+    ULONG_PTR Key;
+    DWORD Bytes;
+    BOOL Success;
+    LARGE_INTEGER Now;
+    ULONG Outstanding = 0;
+    ULONG r;
+
+    for (r = 0; r < DiskCount * QueueDepth; r++) {
+
+        if (IssueRead( Thread, &Thread->Reads[r] )) {
+
+            Outstanding++;
+
+        } else {
+
+            Thread->Failed++;
+        }
+    }
+
+    while (Outstanding != 0) {
+
+        Overlapped = NULL;
+        Success = GetQueuedCompletionStatus( Thread->CompletionPort, &Bytes, &Key, &Overlapped, INFINITE );
+
+        if (Overlapped == NULL) {
+
+            Thread->Failed++;
+            break;
+        }
+
+        QueryPerformanceCounter( &Now );
+
+        Read = CONTAINING_RECORD( Overlapped, BENCH_READ, Overlapped );
+        Outstanding--;
+
+        if (Success && (Bytes == READ_SIZE)) {
+
+            Thread->Completed++;
+            Thread->Latency += Now.QuadPart - Read->Issued.QuadPart;
+
+        } else {
+
+            Thread->Failed++;
+        }
+
+        if (Now.QuadPart < Deadline.QuadPart) {
+
+            if (IssueRead( Thread, Read )) {
+
+                Outstanding++;
+
+            } else {
+
+                Thread->Failed++;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+BOOLEAN
+SetupThread (
+    _Inout_ PBENCH_THREAD Thread
+    )
+{
+    ULONG d;
+    ULONG r;
+
+    Thread->Seed = 0x12345678ULL + Thread->Processor;
+
+    Thread->CompletionPort = CreateIoCompletionPort( INVALID_HANDLE_VALUE, NULL, 0, 1 );
+
+    if (Thread->CompletionPort == NULL) {
+
+        return FALSE;
+    }
+
+    for (d = 0; d < DiskCount; d++) {
+
+        Thread->Disks[d] = OpenDisk( DiskNumbers[d] );
+
+        if ((Thread->Disks[d] == INVALID_HANDLE_VALUE) ||
+            (CreateIoCompletionPort( Thread->Disks[d], Thread->CompletionPort, d, 1 ) == NULL)) {
+
+            return FALSE;
+        }
+    }
+
+    Thread->Reads = calloc( DiskCount * QueueDepth, sizeof( BENCH_READ ) );
+    Thread->Buffers = VirtualAlloc( NULL, (SIZE_T)DiskCount * QueueDepth * READ_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE );
+
+    if ((Thread->Reads == NULL) || (Thread->Buffers == NULL)) {
+
+        return FALSE;
+    }
+
+    for (r = 0; r < DiskCount * QueueDepth; r++) {
+
+        Thread->Reads[r].Disk = r / QueueDepth;
+        Thread->Reads[r].Buffer = Thread->Buffers + (SIZE_T)r * READ_SIZE;
+    }
+
+    return TRUE;
+}
+
+
+VOID
+CleanupThread (
+    _Inout_ PBENCH_THREAD Thread
+    )
+{
+    ULONG d;
+
+    for (d = 0; d < DiskCount; d++) {
+
+        if ((Thread->Disks[d] != NULL) && (Thread->Disks[d] != INVALID_HANDLE_VALUE)) {
+
+            CloseHandle( Thread->Disks[d] );
+        }
+    }
+
+    if (Thread->CompletionPort != NULL) {
+
+        CloseHandle( Thread->CompletionPort );
+    }
+
+    if (Thread->Buffers != NULL) {
+
+        VirtualFree( Thread->Buffers, 0, MEM_RELEASE );
+    }
+
+    free( Thread->Reads );
+}
+
+
+PCSTR
+CurrentCpuSetting (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    Returns how DisableDpcRedirectionCurrentCpu was set, for the report.
+    It is only read by StorAHCI when the adapter starts.
+
+--*/
+
+{
+    DWORD Value = 0;
+    DWORD Size = sizeof( Value );
+
+    if ((RegGetValueW( HKEY_LOCAL_MACHINE,
+                       STORAHCI_DEVICE_PARAMETERS_KEY,
+                       STORAHCI_CURRENT_CPU_VALUE,
+                       RRF_RT_REG_DWORD,
+                       NULL,
+                       &Value,
+                       &Size ) == ERROR_SUCCESS) && (Value != 0)) {
+
+        return "off (DisableDpcRedirectionCurrentCpu = 1)";
+    }
+
+    return "on";
+}
+
+
+VOID
+Usage (
+    VOID
+    )
+{
+    printf( "Usage: iopsBench [-Milliseconds <n>] [-QueueDepth <n>] <disk number> [<disk number> ...]\n" );
+    printf( "    -Milliseconds   time spent reading (default %d)\n", DEFAULT_MILLISECONDS );
+    printf( "    -QueueDepth     reads outstanding per disk per processor (default %d)\n", DEFAULT_QUEUE_DEPTH );
+    printf( "    Disk numbers are those of \\\\.\\PhysicalDrive<n>.  Only reads are issued.\n" );
+}
+
+
+int
+__cdecl
+main (
+    _In_ int argc,
+    _In_reads_(argc) char *argv[]
+    )
+{
+    ULONG Milliseconds = DEFAULT_MILLISECONDS;
+    PBENCH_THREAD Threads;
+    ULONG ThreadCount;
+    GET_LENGTH_INFORMATION LengthInfo;
+    HANDLE Disk;
+    DWORD Bytes;
+    FILETIME IdleStart, KernelStart, UserStart;
+    FILETIME IdleEnd, KernelEnd, UserEnd;
+    LARGE_INTEGER Start;
+    LARGE_INTEGER End;
+    ULONGLONG Completed = 0;
+    ULONGLONG Failed = 0;
+    LONGLONG Latency = 0;
+    ULONGLONG Busy;
+    double Seconds;
+    int Argument;
+    ULONG t;
+
+    for (Argument = 1; Argument < argc; Argument++) {
+
+        if ((_stricmp( argv[Argument], "-Milliseconds" ) == 0) && (Argument + 1 < argc)) {
+
+            Milliseconds = strtoul( argv[++Argument], NULL, 0 );
+
+        } else if ((_stricmp( argv[Argument], "-QueueDepth" ) == 0) && (Argument + 1 < argc)) {
+
+            QueueDepth = strtoul( argv[++Argument], NULL, 0 );
+
+        } else if ((argv[Argument][0] >= '0') && (argv[Argument][0] <= '9') && (DiskCount < MAX_DISKS)) {
+
+            DiskNumbers[DiskCount++] = strtoul( argv[Argument], NULL, 0 );
+
+        } else {
+
+            Usage();
+            return 1;
+        }
+    }
+
+    if ((Milliseconds == 0) || (QueueDepth == 0) || (QueueDepth > MAX_QUEUE_DEPTH) || (DiskCount == 0)) {
+
+        Usage();
+        return 1;
+    }
+
+    for (t = 0; t < DiskCount; t++) {
+
+        Disk = OpenDisk( DiskNumbers[t] );
+
+        if (Disk == INVALID_HANDLE_VALUE) {
+
+            printf( "Could not open PhysicalDrive%u, error %u\n", DiskNumbers[t], GetLastError() );
+            return 1;
+        }
+
+        if (!DeviceIoControl( Disk, IOCTL_DISK_GET_LENGTH_INFO, NULL, 0, &LengthInfo, sizeof( LengthInfo ), &Bytes, NULL ) ||
+            (LengthInfo.Length.QuadPart < READ_SIZE)) {
+
+            printf( "Could not get the length of PhysicalDrive%u, error %u\n", DiskNumbers[t], GetLastError() );
+            CloseHandle( Disk );
+            return 1;
+        }
+
+        DiskBlocks[t] = (ULONGLONG)LengthInfo.Length.QuadPart / READ_SIZE;
+        CloseHandle( Disk );
+    }
+
+    //
+    //  The threads are bound with SetThreadAffinityMask, so they stay in
+    //  the benchmark's processor group.
+    //
+
+    ThreadCount = GetActiveProcessorCount( 0 );
+
+    Threads = calloc( ThreadCount, sizeof( BENCH_THREAD ) );
+
+    if (Threads == NULL) {
+
+        printf( "Out of memory\n" );
+        return 1;
+    }
+
+    for (t = 0; t < ThreadCount; t++) {
+
+        Threads[t].Processor = t;
+
+        if (!SetupThread( &Threads[t] )) {
+
+            printf( "Could not set up the thread for processor %u, error %u\n", t, GetLastError() );
+            return 1;
+        }
+    }
+
+    QueryPerformanceFrequency( &Frequency );
+
+    printf( "Completion on the issuing processor: %s\n", CurrentCpuSetting() );
+    printf( "%u disks, %u processors, queue depth %u per disk per processor, %u ms\n",
+            DiskCount, ThreadCount, QueueDepth, Milliseconds );
+
+    GetSystemTimes( &IdleStart, &KernelStart, &UserStart );
+    QueryPerformanceCounter( &Start );
+
+    Deadline.QuadPart = Start.QuadPart + Frequency.QuadPart * Milliseconds / 1000;
+
+    for (t = 0; t < ThreadCount; t++) {
+
+        Threads[t].Thread = CreateThread( NULL, 0, BenchThread, &Threads[t], CREATE_SUSPENDED, NULL );
+
+        if (Threads[t].Thread == NULL) {
+
+            printf( "Could not create a thread, error %u\n", GetLastError() );
+            return 1;
+        }
+
+        SetThreadAffinityMask( Threads[t].Thread, (DWORD_PTR)1 << t );
+        SetThreadPriority( Threads[t].Thread, THREAD_PRIORITY_HIGHEST );
+        ResumeThread( Threads[t].Thread );
+    }
+
+    for (t = 0; t < ThreadCount; t++) {
+
+        WaitForSingleObject( Threads[t].Thread, INFINITE );
+        CloseHandle( Threads[t].Thread );
+    }
+
+    QueryPerformanceCounter( &End );
+    GetSystemTimes( &IdleEnd, &KernelEnd, &UserEnd );
+
+    for (t = 0; t < ThreadCount; t++) {
+
+        Completed += Threads[t].Completed;
+        Failed += Threads[t].Failed;
+        Latency += Threads[t].Latency;
+
+        CleanupThread( &Threads[t] );
+    }
+
+    free( Threads );
+
+    //
+    //  The kernel time GetSystemTimes returns includes the idle time.
+    //
+
+    Busy = (FileTimeValue( &KernelEnd ) - FileTimeValue( &KernelStart )) +
+           (FileTimeValue( &UserEnd ) - FileTimeValue( &UserStart )) -
+           (FileTimeValue( &IdleEnd ) - FileTimeValue( &IdleStart ));
+
+    Seconds = (double)(End.QuadPart - Start.QuadPart) / (double)Frequency.QuadPart;
+
+    printf( "%12s %12s %12s\n", "reads/s", "us/read", "cpu us/read" );
+
+    if (Completed != 0) {
+
+        printf( "%12.0f %12.1f %12.2f\n",
+                (double)Completed / Seconds,
+                (double)Latency * 1e6 / (double)Frequency.QuadPart / (double)Completed,
+                (double)Busy / 10.0 / (double)Completed );
+    }
+
+    if (Failed != 0) {
+
+        printf( "\n%I64u reads failed\n", Failed );
+        return 2;
+    }
+
+    return 0;
+}
@@ -0,0 +1,402 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All Rights Reserved
+
+Module Name:
+
+    slotBench.c
+
+Abstract:
+
+    A benchmark for the completed slot walk of AhciCompleteIssuedSRBs.
+
+    AhciCompleteIssuedSRBs used to test every slot from 0 to CAP.NCS
+    against CommandsToComplete; it now uses BitScanForward to skip straight
+    to the next set bit.  The benchmark replays the same completion masks
+    through both walks, for a 32 slot and an 8 slot controller and for
+    interrupts that complete from one to every slot, checks that both visit
+    the same slots in the same order, and times them.
+
+    The two walks are copies of the loop in io.c with the slot body
+    replaced by what ReleaseSlottedCommand does to the mask, which is to
+    clear the slot's bit.  Keep them in step with io.c.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_code_)
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define DEFAULT_MILLISECONDS    200
+
+//
+//  Masks replayed per timed call, so that the branch predictors cannot
+//  learn one mask.
+//
+
+#define MASK_COUNT              4096
+
+typedef ULONG
+(*PSLOT_WALK_ROUTINE) (
+    _In_ ULONG CommandsToComplete,
+    _In_ UCHAR Ncs,
+    _Out_writes_to_(32, return) PUCHAR Visited
+    );
+
+typedef struct _BENCH_ROUTINE {
+
+    PCSTR Name;
+    PSLOT_WALK_ROUTINE Routine;
+
+} BENCH_ROUTINE, *PBENCH_ROUTINE;
+
+
+ULONG
+SlotWalkEverySlot (
+    _In_ ULONG CommandsToComplete,
+    _In_ UCHAR Ncs,
+    _Out_writes_to_(32, return) PUCHAR Visited
+    )
+
+/*++
+
+Routine Description:
+
+    The walk AhciCompleteIssuedSRBs used to do: test each slot in turn.
+
+--*/
+
+{
+    ULONG count = 0;
+    UCHAR i;
+
+    for (i = 0; i <= Ncs; i++) {
+        if( ( CommandsToComplete & (1UL << i) ) > 0) {
+            Visited[count++] = i;
+            CommandsToComplete &= ~(1UL << i);
+        }
+    }
+
+    return count;
+}
+
+
+ULONG
+SlotWalkBitScan (
+    _In_ ULONG CommandsToComplete,
+    _In_ UCHAR Ncs,
+    _Out_writes_to_(32, return) PUCHAR Visited
+    )
+
+/*++
+
+Routine Description:
+
+    The walk AhciCompleteIssuedSRBs does now: skip to the next set bit.
+
+--*/
+
+{
+    ULONG count = 0;
+    ULONG slotIndex;
+    ULONG validSlots;
+    UCHAR i;
+
+    validSlots = (Ncs == 31) ? MAXULONG : ((1UL << (Ncs + 1)) - 1);
+
+    for (i = 0; i <= Ncs; i++) {
+        if (!BitScanForward(&slotIndex, CommandsToComplete & validSlots & ~((1UL << i) - 1))) {
+            break;
+        }
+        i = (UCHAR)slotIndex;
+
+        if( ( CommandsToComplete & (1UL << i) ) > 0) {
+            Visited[count++] = i;
+            CommandsToComplete &= ~(1UL << i);
+        }
+    }
+
+    return count;
+}
+
+
+//
+//  The old walk comes first; it is the one the new one is checked and
+//  compared against.
+//
+
+BENCH_ROUTINE Routines[] = {
+    { "EverySlot", SlotWalkEverySlot },
+    { "BitScan",   SlotWalkBitScan },
+};
+
+//
+//  CAP.NCS of a 32 slot NCQ controller and of an 8 slot one.
+//
+
+const UCHAR Ncs[] = { 31, 7 };
+
+//
+//  Slots completed by one interrupt: a single command at queue depth 1,
+//  a few at moderate depth, and a full queue.
+//
+
+const ULONG SetBits[] = { 1, 2, 4, 8, 16, 32 };
+
+ULONG Masks[MASK_COUNT];
+
+LARGE_INTEGER Frequency;
+
+volatile ULONG Sink;
+
+
+VOID
+FillMasks (
+    _In_ UCHAR Ncs,
+    _In_ ULONG SetBits
+    )
+
+/*++
+
+Routine Description:
+
+    Fills Masks with masks of SetBits random slots out of 0 ~ Ncs, or of
+    every slot if there are fewer than that.
+
+--*/
+
+{
+    ULONG Seed = 0x12345678;
+    ULONG m;
+    ULONG bits;
+    ULONG slot;
+
+    if (SetBits > (ULONG)Ncs + 1) {
+
+        SetBits = (ULONG)Ncs + 1;
+    }
+
+    for (m = 0; m < MASK_COUNT; m++) {
+
+        Masks[m] = 0;
+
+        for (bits = 0; bits < SetBits; ) {
+
+            Seed = Seed * 1664525 + 1013904223;
+            slot = (Seed >> 24) % ((ULONG)Ncs + 1);
+
+            if ((Masks[m] & (1UL << slot)) == 0) {
+
+                Masks[m] |= (1UL << slot);
+                bits++;
+            }
+        }
+    }
+}
+
+
+BOOLEAN
+CheckRoutine (
+    _In_ PBENCH_ROUTINE Routine,
+    _In_ UCHAR Ncs
+    )
+
+/*++
+
+Routine Description:
+
+    Walks every mask with Routine and with the old walk and compares the
+    slots visited and their order.
+
+--*/
+
+{
+    UCHAR Expected[32];
+    UCHAR Actual[32];
+    ULONG ExpectedCount;
+    ULONG ActualCount;
+    ULONG m;
+
+    for (m = 0; m < MASK_COUNT; m++) {
+
+        ExpectedCount = SlotWalkEverySlot( Masks[m], Ncs, Expected );
+        ActualCount = Routine->Routine( Masks[m], Ncs, Actual );
+
+        if ((ExpectedCount != ActualCount) ||
+            (memcmp( Expected, Actual, ExpectedCount ) != 0)) {
+
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+double
+TimeRoutine (
+    _In_ PBENCH_ROUTINE Routine,
+    _In_ UCHAR Ncs,
+    _In_ ULONG Milliseconds
+    )
+
+/*++
+
+Routine Description:
+
+    Returns the average time to walk one mask in nanoseconds.
+
+--*/
+
+{
+    UCHAR Visited[32];
+    LARGE_INTEGER Start;
+    LARGE_INTEGER Now;
+    LONGLONG Budget;
+    ULONGLONG Calls = 0;
+    ULONG Total = 0;
+    ULONG m;
+
+    //
+    //  Warm up the caches and the branch predictors.
+    //
+
+    for (m = 0; m < 16; m++) {
+
+        Total += Routine->Routine( Masks[m], Ncs, Visited );
+    }
+
+    Budget = Frequency.QuadPart * Milliseconds / 1000;
+
+    QueryPerformanceCounter( &Start );
+
+    do {
+
+        for (m = 0; m < MASK_COUNT; m++) {
+
+            Total += Routine->Routine( Masks[m], Ncs, Visited );
+        }
+
+        Calls += MASK_COUNT;
+
+        QueryPerformanceCounter( &Now );
+
+    } while (Now.QuadPart - Start.QuadPart < Budget);
+
+    Sink = Total;
+
+    return (double)(Now.QuadPart - Start.QuadPart) * 1e9 / (double)Frequency.QuadPart / (double)Calls;
+}
+
+
+VOID
+Usage (
+    VOID
+    )
+{
+    printf( "Usage: slotBench [-Milliseconds <n>]\n" );
+    printf( "    -Milliseconds   time spent on each case (default %d)\n", DEFAULT_MILLISECONDS );
+}
+
+
+int
+__cdecl
+main (
+    _In_ int argc,
+    _In_reads_(argc) char *argv[]
+    )
+{
+    ULONG Milliseconds = DEFAULT_MILLISECONDS;
+    int Argument;
+    int Failures = 0;
+    ULONG n, b, r;
+    double Baseline;
+    double Time;
+
+    for (Argument = 1; Argument < argc; Argument++) {
+
+        if ((_stricmp( argv[Argument], "-Milliseconds" ) == 0) && (Argument + 1 < argc)) {
+
+            Milliseconds = strtoul( argv[++Argument], NULL, 0 );
+
+        } else {
+
+            Usage();
+            return 1;
+        }
+    }
+
+    if (Milliseconds == 0) {
+
+        Usage();
+        return 1;
+    }
+
+    QueryPerformanceFrequency( &Frequency );
+
+    //
+    //  Keep the timing thread on one processor and ahead of the rest of
+    //  the system.
+    //
+
+    SetThreadAffinityMask( GetCurrentThread(), 1 );
+    SetThreadPriority( GetCurrentThread(), THREAD_PRIORITY_HIGHEST );
+
+    printf( "%-10s %4s %8s %12s %8s\n",
+            "Routine", "NCS", "Slots", "ns/mask", "vs old" );
+
+    for (n = 0; n < ARRAYSIZE( Ncs ); n++) {
+
+        for (b = 0; b < ARRAYSIZE( SetBits ); b++) {
+
+            if ((b > 0) && (SetBits[b - 1] >= (ULONG)Ncs[n] + 1)) {
+
+                break;
+            }
+
+            FillMasks( Ncs[n], SetBits[b] );
+
+            Baseline = 0.0;
+
+            for (r = 0; r < ARRAYSIZE( Routines ); r++) {
+
+                if ((r > 0) && !CheckRoutine( &Routines[r], Ncs[n] )) {
+
+                    printf( "%-10s %4u %8u    MISMATCH against the old walk\n",
+                            Routines[r].Name, Ncs[n], SetBits[b] );
+                    Failures++;
+                    continue;
+                }
+
+                Time = TimeRoutine( &Routines[r], Ncs[n], Milliseconds );
+
+                if (r == 0) {
+
+                    Baseline = Time;
+                }
+
+                printf( "%-10s %4u %8u %12.1f %7.2fx\n",
+                        Routines[r].Name,
+                        Ncs[n],
+                        min( SetBits[b], (ULONG)Ncs[n] + 1 ),
+                        Time,
+                        Baseline / Time );
+            }
+        }
+    }
+
+    if (Failures != 0) {
+
+        printf( "\n%d routine checks failed\n", Failures );
+        return 2;
+    }
+
+    return 0;
+}
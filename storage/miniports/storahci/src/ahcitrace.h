@@ -0,0 +1,62 @@
+/*++
+
+Copyright (C) Microsoft Corporation, 2009
+
+Module Name:
+
+    ahcitrace.h
+
+Abstract:
+
+    Layout of the per-port command trace and the private adapter IOCTL that
+    exports it. This file is shared by storahci and the ahcitrace tool.
+
+    The tool sends IOCTL_SCSI_MINIPORT to the adapter (\\.\ScsiN:) with an
+    SRB_IO_CONTROL header whose Signature is STORAHCI_TRACE_SIGNATURE and whose
+    ControlCode is IOCTL_STORAHCI_QUERY_COMMAND_TRACE, followed by an
+    AHCI_COMMAND_TRACE_QUERY.
+
+Notes:
+
+Revision History:
+
+--*/
+
+#pragma once
+
+#define STORAHCI_TRACE_SIGNATURE                "AHCITRCE"
+#define IOCTL_STORAHCI_QUERY_COMMAND_TRACE      ((FILE_DEVICE_SCSI << 16) + 0x0F00)
+
+// must be a power of 2
+#define AHCI_COMMAND_TRACE_ENTRY_COUNT          256
+
+// values for AHCI_COMMAND_TRACE_ENTRY.Flags
+#define AHCI_COMMAND_TRACE_FLAG_NCQ             0x01
+#define AHCI_COMMAND_TRACE_FLAG_ATAPI           0x02    // Command is a SCSI operation code
+
+//
+// One entry per completed command, 32 bytes so that two entries share a cache line.
+//
+typedef struct _AHCI_COMMAND_TRACE_ENTRY {
+    ULONGLONG   StartTime;              // performance counter when the command was issued to the port
+    ULONG       Duration;               // issue to completion, in 100ns units
+    ULONG       DataTransferLength;
+    UCHAR       Command;                // ATA command register, or SCSI operation code for ATAPI
+    UCHAR       Tag;
+    UCHAR       SrbStatus;
+    UCHAR       Flags;
+    ULONG       Reserved[3];
+} AHCI_COMMAND_TRACE_ENTRY, *PAHCI_COMMAND_TRACE_ENTRY;
+
+#define AHCI_COMMAND_TRACE_QUERY_VERSION        1
+
+typedef struct _AHCI_COMMAND_TRACE_QUERY {
+    ULONG       Version;                // in: AHCI_COMMAND_TRACE_QUERY_VERSION
+    ULONG       PortNumber;             // in
+    ULONG       EntryCount;             // out: number of valid entries, oldest first
+    ULONG       Reserved;
+    ULONGLONG   TotalCommands;          // out: commands traced since the port was started
+    ULONGLONG   PerformanceFrequency;   // out: to convert StartTime
+    AHCI_COMMAND_TRACE_ENTRY Entries[AHCI_COMMAND_TRACE_ENTRY_COUNT];
+} AHCI_COMMAND_TRACE_QUERY, *PAHCI_COMMAND_TRACE_QUERY;
+
@@ -85,6 +85,12 @@ QueryPhysicalTopologyIoctlProcess(
     _In_ PSTORAGE_REQUEST_BLOCK Srb
     );
 
+ULONG
+QueryCommandTraceIoctlProcess(
+    _In_ PAHCI_ADAPTER_EXTENSION AdapterExtension,
+    _In_ PSTORAGE_REQUEST_BLOCK Srb
+    );
+
 ULONG
 SCSItoATA(
     _In_ PAHCI_CHANNEL_EXTENSION ChannelExtension,
@@ -1157,6 +1163,26 @@ Notes:
         }
     }
 
+    //
+    // Track hot LBA ranges on hybrid devices. A priority passed in by the upper layers wins over the heat map.
+    //
+    if ((ChannelExtension->HybridHeatMap != NULL) &&
+        !IsDumpMode(ChannelExtension->AdapterExtension) &&
+        IsDeviceHybridInfoEnabled(ChannelExtension) &&
+        IsNcqReadWriteCommand(srbExtension)) {
+
+        UCHAR priority = 0;
+
+        if (HybridHeatMapUpdate(ChannelExtension, (ULONG64)startingSector.QuadPart, &priority) && !hybridPriorityPassedIn) {
+            ATA_HYBRID_INFO_FIELDS hybridInfo = {0};
+
+            hybridInfo.InfoValid = 1;
+            hybridInfo.HybridPriority = priority;
+
+            cfis->Auxiliary23_16 = hybridInfo.AsUchar;
+        }
+    }
+
 
     return;
 }
@@ -2777,6 +2803,111 @@ GetDataBufferLengthForDsmCommand (
     return bufferLength;
 }
 
+ULONG
+CoalesceUnmapBlockDescriptors (
+    _Inout_updates_(BlockDescrCount) PUNMAP_BLOCK_DESCRIPTOR BlockDescriptors,
+    _In_ ULONG BlockDescrCount
+    )
+/*++
+
+Routine Description:
+
+    Sort UNMAP_BLOCK_DESCRIPTOR entries by starting LBA and merge the ones that overlap or are adjacent.
+
+    File system deletes usually arrive as many small, often neighbouring ranges. Merging them cuts down
+    the ATA_LBA_RANGE entries needed, so each 512 bytes DSM payload block covers more of the disk and
+    fewer DSM commands are sent to the device.
+
+Arguments:
+
+    BlockDescriptors - the entries are sorted and compacted in place
+    BlockDescrCount
+
+Return Value:
+
+    Count of UNMAP_BLOCK_DESCRIPTOR entries left. Entries with LbaCount 0 are dropped.
+
+--*/
+{
+    ULONG       gap;
+    ULONG       i;
+    ULONG       j;
+    ULONG       mergedCount = 0;
+    ULONGLONG   currentLba = 0;
+    ULONGLONG   currentEnd = 0;
+    ULONG       currentLbaCount;
+
+    // 1. shell sort on starting LBA. An UNMAP parameter list carries at most 0xFFFE / 16 entries, sorting in place needs no extra allocation.
+    for (gap = BlockDescrCount / 2; gap > 0; gap /= 2) {
+        for (i = gap; i < BlockDescrCount; i++) {
+            UNMAP_BLOCK_DESCRIPTOR  tempBlockDescr;
+            ULONGLONG               tempLba;
+
+            StorPortCopyMemory(&tempBlockDescr, &BlockDescriptors[i], sizeof(UNMAP_BLOCK_DESCRIPTOR));
+            REVERSE_BYTES_QUAD(&tempLba, tempBlockDescr.StartingLba);
+
+            for (j = i; j >= gap; j -= gap) {
+                ULONGLONG   lba;
+
+                REVERSE_BYTES_QUAD(&lba, BlockDescriptors[j - gap].StartingLba);
+                if (lba <= tempLba) {
+                    break;
+                }
+                StorPortCopyMemory(&BlockDescriptors[j], &BlockDescriptors[j - gap], sizeof(UNMAP_BLOCK_DESCRIPTOR));
+            }
+
+            StorPortCopyMemory(&BlockDescriptors[j], &tempBlockDescr, sizeof(UNMAP_BLOCK_DESCRIPTOR));
+        }
+    }
+
+    // 2. merge overlapping or adjacent entries. LbaCount is 32 bits, a merged entry can not grow beyond MAXULONG sectors.
+    for (i = 0; i < BlockDescrCount; i++) {
+        ULONGLONG   lba;
+        ULONG       lbaCount;
+        ULONGLONG   end;
+
+        REVERSE_BYTES_QUAD(&lba, BlockDescriptors[i].StartingLba);
+        REVERSE_BYTES(&lbaCount, BlockDescriptors[i].LbaCount);
+
+        if (lbaCount == 0) {
+            continue;
+        }
+
+        end = lba + lbaCount;
+
+        if ((mergedCount > 0) && (lba <= currentEnd) && (end <= currentEnd)) {
+            // 2.1 entry is covered by the current one
+            continue;
+        }
+
+        if ((mergedCount > 0) && (lba <= currentEnd) && ((end - currentLba) <= MAXULONG)) {
+            // 2.2 extend the current entry
+            currentEnd = end;
+        } else {
+            // 2.3 write back the current entry and start a new one
+            if (mergedCount > 0) {
+                currentLbaCount = (ULONG)(currentEnd - currentLba);
+                AhciZeroMemory((PCHAR)&BlockDescriptors[mergedCount - 1], sizeof(UNMAP_BLOCK_DESCRIPTOR));
+                REVERSE_BYTES_QUAD(BlockDescriptors[mergedCount - 1].StartingLba, &currentLba);
+                REVERSE_BYTES(BlockDescriptors[mergedCount - 1].LbaCount, &currentLbaCount);
+            }
+
+            currentLba = lba;
+            currentEnd = end;
+            mergedCount++;
+        }
+    }
+
+    if (mergedCount > 0) {
+        currentLbaCount = (ULONG)(currentEnd - currentLba);
+        AhciZeroMemory((PCHAR)&BlockDescriptors[mergedCount - 1], sizeof(UNMAP_BLOCK_DESCRIPTOR));
+        REVERSE_BYTES_QUAD(BlockDescriptors[mergedCount - 1].StartingLba, &currentLba);
+        REVERSE_BYTES(BlockDescriptors[mergedCount - 1].LbaCount, &currentLbaCount);
+    }
+
+    return mergedCount;
+}
+
 VOID
 DeviceProcessTrimRequest(
     _In_ PAHCI_CHANNEL_EXTENSION ChannelExtension,
@@ -2850,22 +2981,38 @@ Return Value:
                 // get ATA block count, the value is needed for setting the DSM command.
                 ULONG transferBlockCount = bufferLength / ATA_BLOCK_SIZE;
 
-                srbExtension->AtaFunction = ATA_FUNCTION_ATA_COMMAND;
                 srbExtension->DataBuffer = buffer;
                 srbExtension->DataTransferLength = bufferLength;
 
-                // ATA command taskfile
-                AhciZeroMemory((PCHAR)&srbExtension->TaskFile, sizeof(ATA_TASK_FILE));
+                if (trimContext->UseQueuedTrim) {
+                    // SEND FPDMA QUEUED - DATA SET MANAGEMENT, TRIM bit in AUXILIARY field.
+                    // transfer block count is in Feature field; NCQ tag is filled in Count field when the command is issued.
+                    AhciZeroMemory((PCHAR)&srbExtension->Cfis, sizeof(AHCI_H2D_REGISTER_FIS));
+
+                    srbExtension->AtaFunction = ATA_FUNCTION_ATA_CFIS_PAYLOAD;
 
-                srbExtension->TaskFile.Current.bFeaturesReg = IDE_DSM_FEATURE_TRIM;
-                // For TRIM command: LBA bit (bit 6) needs to be set for Device Register;
-                // bit 7 and bit 5 are obsolete and always set by ATAport;
-                // bit 4 is to select device0 or device1
-                srbExtension->TaskFile.Current.bDriveHeadReg = 0xE0;
-                srbExtension->TaskFile.Current.bCommandReg = IDE_COMMAND_DATA_SET_MANAGEMENT;
+                    srbExtension->Cfis.Feature7_0 = (UCHAR)(0x00FF & transferBlockCount);
+                    srbExtension->Cfis.Feature15_8 = (UCHAR)(transferBlockCount >> 8);
+                    srbExtension->Cfis.Count15_8 = IDE_NCQ_SEND_DATA_SET_MANAGEMENT;
+                    srbExtension->Cfis.Auxiliary7_0 = IDE_DSM_FEATURE_TRIM;
+                    srbExtension->Cfis.Device |= (1 << 6);
+                    srbExtension->Cfis.Command = IDE_COMMAND_SEND_FPDMA_QUEUED;
+                } else {
+                    srbExtension->AtaFunction = ATA_FUNCTION_ATA_COMMAND;
+
+                    // ATA command taskfile
+                    AhciZeroMemory((PCHAR)&srbExtension->TaskFile, sizeof(ATA_TASK_FILE));
 
-                srbExtension->TaskFile.Current.bSectorCountReg = (UCHAR)(0x00FF & transferBlockCount);
-                srbExtension->TaskFile.Previous.bSectorCountReg = (UCHAR)(transferBlockCount >> 8);
+                    srbExtension->TaskFile.Current.bFeaturesReg = IDE_DSM_FEATURE_TRIM;
+                    // For TRIM command: LBA bit (bit 6) needs to be set for Device Register;
+                    // bit 7 and bit 5 are obsolete and always set by ATAport;
+                    // bit 4 is to select device0 or device1
+                    srbExtension->TaskFile.Current.bDriveHeadReg = 0xE0;
+                    srbExtension->TaskFile.Current.bCommandReg = IDE_COMMAND_DATA_SET_MANAGEMENT;
+
+                    srbExtension->TaskFile.Current.bSectorCountReg = (UCHAR)(0x00FF & transferBlockCount);
+                    srbExtension->TaskFile.Previous.bSectorCountReg = (UCHAR)(transferBlockCount >> 8);
+                }
 
                 srbExtension->CompletionRoutine = DeviceProcessTrimRequest;
                 srbExtension->CompletionContext = (PVOID)trimContext;
@@ -2934,9 +3081,16 @@ AtaUnmapRequest (
         // some preparation work before actually starting to process the request
         ULONG                 i = 0;
         ULONG                 length = 0;
+        ULONG                 blockDescrCount = 0;
         STOR_PHYSICAL_ADDRESS bufferPhysicalAddress;
 
-        status = StorPortAllocatePool(ChannelExtension->AdapterExtension, sizeof(ATA_TRIM_CONTEXT), AHCI_POOL_TAG, (PVOID*)&trimContext);
+        // the Block Descriptors are sorted and merged in a private copy that follows the context, so the caller's parameter list is not modified.
+        blockDescrCount = blockDescrDataLength / sizeof(UNMAP_BLOCK_DESCRIPTOR);
+
+        status = StorPortAllocatePool(ChannelExtension->AdapterExtension,
+                                      sizeof(ATA_TRIM_CONTEXT) + blockDescrCount * sizeof(UNMAP_BLOCK_DESCRIPTOR),
+                                      AHCI_POOL_TAG,
+                                      (PVOID*)&trimContext);
         if ( (status != STOR_STATUS_SUCCESS) || (trimContext == NULL) ) {
             Srb->SrbStatus = SRB_STATUS_INVALID_REQUEST;
             if (status == STOR_STATUS_SUCCESS) {
@@ -2946,8 +3100,14 @@ AtaUnmapRequest (
         }
         AhciZeroMemory((PCHAR)trimContext, sizeof(ATA_TRIM_CONTEXT));
 
-        trimContext->BlockDescriptors = (PUNMAP_BLOCK_DESCRIPTOR)((PCHAR)srbDataBuffer + 8);
-        trimContext->BlockDescrCount = blockDescrDataLength / sizeof(UNMAP_BLOCK_DESCRIPTOR);
+        trimContext->BlockDescriptors = (PUNMAP_BLOCK_DESCRIPTOR)(trimContext + 1);
+        StorPortCopyMemory(trimContext->BlockDescriptors, (PCHAR)srbDataBuffer + 8, blockDescrCount * sizeof(UNMAP_BLOCK_DESCRIPTOR));
+
+        // 1.0 sort and merge the ranges so that DSM payloads are filled with as few ATA Lba Range entries as possible.
+        trimContext->BlockDescrCount = CoalesceUnmapBlockDescriptors(trimContext->BlockDescriptors, blockDescrCount);
+
+        // queued TRIM does not block other NCQ commands on the device while the ranges are processed.
+        trimContext->UseQueuedTrim = IsDeviceSupportsQueuedTrim(ChannelExtension);
 
         // 1.1 calculate how many ATA Lba entries can be sent per DSM command
         //     every device LBA entry takes 8 bytes. not worry about multiply overflow as max of DsmCapBlockCount is 0xFFFF
@@ -3928,6 +4088,8 @@ Return Value:
 
     SelectDeviceGeometry(ChannelExtension, deviceParameters, identifyDeviceData);
 
+    HybridHeatMapReset(ChannelExtension);
+
     return;
 }
 
@@ -3970,6 +4132,19 @@ Return Value:
 
             break;
 
+        case IOCTL_STORAHCI_QUERY_COMMAND_TRACE:
+            if (CompareId(STORAHCI_TRACE_SIGNATURE,
+                          8,
+                          (PSTR)srbControl->Signature,
+                          8,
+                          NULL)) {
+
+                QueryCommandTraceIoctlProcess(AdapterExtension, Srb);
+                processed = TRUE;
+            }
+
+            break;
+
         default:
             break;
     }
@@ -7883,6 +8058,93 @@ exit:
     return status;
 }
 
+ULONG
+QueryCommandTraceIoctlProcess(
+    _In_ PAHCI_ADAPTER_EXTENSION AdapterExtension,
+    _In_ PSTORAGE_REQUEST_BLOCK Srb
+    )
+/*++
+Routine Description:
+
+    IOCTL handling routine returns the command trace of a port, oldest entry first.
+    The trace lets a user mode tool look at command latencies without a checked build.
+
+Arguments:
+    AdapterExtension
+    SRB
+
+Return Value:
+
+    STOR Status
+
+--*/
+{
+    ULONG                       status = STOR_STATUS_SUCCESS;
+    ULONG                       srbDataBufferLength = 0;
+    PSRB_IO_CONTROL             srbControl = NULL;
+    PAHCI_COMMAND_TRACE_QUERY   traceQuery = NULL;
+    PAHCI_CHANNEL_EXTENSION     channelExtension = NULL;
+    STOR_LOCK_HANDLE            lockhandle = {0};
+    LARGE_INTEGER               perfFrequency = {0};
+    ULONGLONG                   first;
+    ULONG                       count;
+    ULONG                       i;
+
+    srbControl = (PSRB_IO_CONTROL)SrbGetDataBuffer(Srb);
+    srbDataBufferLength = SrbGetDataTransferLength(Srb);
+
+    if (srbDataBufferLength < (sizeof(SRB_IO_CONTROL) + sizeof(AHCI_COMMAND_TRACE_QUERY))) {
+        Srb->SrbStatus = SRB_STATUS_BAD_SRB_BLOCK_LENGTH;
+        status = STOR_STATUS_BUFFER_TOO_SMALL;
+        goto exit;
+    }
+
+    traceQuery = (PAHCI_COMMAND_TRACE_QUERY)(srbControl + 1);
+
+    if ((traceQuery->Version != AHCI_COMMAND_TRACE_QUERY_VERSION) ||
+        (traceQuery->PortNumber > AdapterExtension->HighestPort) ||
+        (AdapterExtension->PortExtension[traceQuery->PortNumber] == NULL)) {
+        Srb->SrbStatus = SRB_STATUS_INVALID_REQUEST;
+        status = STOR_STATUS_INVALID_PARAMETER;
+        goto exit;
+    }
+
+    channelExtension = AdapterExtension->PortExtension[traceQuery->PortNumber];
+
+    if (channelExtension->CommandTrace == NULL) {
+        Srb->SrbStatus = SRB_STATUS_INVALID_REQUEST;
+        status = STOR_STATUS_INVALID_DEVICE_REQUEST;
+        goto exit;
+    }
+
+    StorPortQueryPerformanceCounter((PVOID)AdapterExtension, &perfFrequency, NULL);
+
+    //
+    // The trace is written under the port interrupt lock on command completion.
+    //
+    AhciInterruptSpinlockAcquire(AdapterExtension, channelExtension->PortNumber, &lockhandle);
+
+    count = (ULONG)min(channelExtension->CommandTraceCount, AHCI_COMMAND_TRACE_ENTRY_COUNT);
+    first = channelExtension->CommandTraceCount - count;
+
+    for (i = 0; i < count; i++) {
+        traceQuery->Entries[i] = channelExtension->CommandTrace[(first + i) & (AHCI_COMMAND_TRACE_ENTRY_COUNT - 1)];
+    }
+
+    traceQuery->TotalCommands = channelExtension->CommandTraceCount;
+
+    AhciInterruptSpinlockRelease(AdapterExtension, channelExtension->PortNumber, &lockhandle);
+
+    traceQuery->EntryCount = count;
+    traceQuery->PerformanceFrequency = (ULONGLONG)perfFrequency.QuadPart;
+
+    Srb->SrbStatus = SRB_STATUS_SUCCESS;
+
+exit:
+
+    return status;
+}
+
 
 
 #if _MSC_VER >= 1200
@@ -44,6 +44,10 @@ Revision History:
 
 #define IDE_FEATURE_INVALID                     0xFF
 
+#ifndef IDE_NCQ_SEND_DATA_SET_MANAGEMENT
+#define IDE_NCQ_SEND_DATA_SET_MANAGEMENT        0x00    // SEND FPDMA QUEUED subcommand
+#endif
+
 
 //
 // ATA function code
@@ -257,6 +261,9 @@ typedef struct _ATA_TRIM_CONTEXT {
     // current UNMAP Block Descriptor being processed
     UNMAP_BLOCK_DESCRIPTOR  CurrentBlockDescr;
 
+    // TRUE if the DSM payloads are sent as SEND FPDMA QUEUED instead of non-queued DATA SET MANAGEMENT
+    BOOLEAN UseQueuedTrim;
+
 } ATA_TRIM_CONTEXT, *PATA_TRIM_CONTEXT;
 
 typedef struct _HYBRID_CHANGE_BY_LBA_CONTEXT {
@@ -338,6 +338,33 @@ AllocateResourcesForAdapter(
             AdapterExtension->PortExtension[i]->DeviceExtension[0].IdentifyDeviceData = (PIDENTIFY_DEVICE_DATA)((PCHAR)AdapterExtension->PortExtension[i]->Sense.SrbExtension + paddedSrbExtensionSize);
             AdapterExtension->PortExtension[i]->DeviceExtension[0].ReadLogExtPageData = (PUSHORT)((PCHAR)AdapterExtension->PortExtension[i]->DeviceExtension[0].IdentifyDeviceData + sizeof(IDENTIFY_DEVICE_DATA));
             AdapterExtension->PortExtension[i]->DeviceExtension[0].InquiryData = (PUCHAR)((PCHAR)AdapterExtension->PortExtension[i]->DeviceExtension[0].ReadLogExtPageData + ATA_BLOCK_SIZE);
+
+            // command trace is best effort, the port works without it.
+            if (!IsDumpMode(AdapterExtension)) {
+                ULONG status;
+                status = StorPortAllocatePool(AdapterExtension,
+                                              sizeof(AHCI_COMMAND_TRACE_ENTRY) * AHCI_COMMAND_TRACE_ENTRY_COUNT,
+                                              AHCI_POOL_TAG,
+                                              (PVOID*)&AdapterExtension->PortExtension[i]->CommandTrace);
+
+                if ((status == STOR_STATUS_SUCCESS) && (AdapterExtension->PortExtension[i]->CommandTrace != NULL)) {
+                    AhciZeroMemory((PCHAR)AdapterExtension->PortExtension[i]->CommandTrace, sizeof(AHCI_COMMAND_TRACE_ENTRY) * AHCI_COMMAND_TRACE_ENTRY_COUNT);
+                } else {
+                    AdapterExtension->PortExtension[i]->CommandTrace = NULL;
+                }
+
+                // hot LBA tracking is also best effort, hybrid devices fall back to the priorities from the upper layers.
+                status = StorPortAllocatePool(AdapterExtension,
+                                              sizeof(AHCI_HYBRID_HEAT_MAP),
+                                              AHCI_POOL_TAG,
+                                              (PVOID*)&AdapterExtension->PortExtension[i]->HybridHeatMap);
+
+                if ((status == STOR_STATUS_SUCCESS) && (AdapterExtension->PortExtension[i]->HybridHeatMap != NULL)) {
+                    AhciZeroMemory((PCHAR)AdapterExtension->PortExtension[i]->HybridHeatMap, sizeof(AHCI_HYBRID_HEAT_MAP));
+                } else {
+                    AdapterExtension->PortExtension[i]->HybridHeatMap = NULL;
+                }
+            }
             //
             j++;
         }
@@ -373,6 +400,7 @@ It performs:
     (details)
     1.1 Get dump mode
     1.2 Gather Vendor,Device,Revision IDs from PCI
+    1.3 Read the adapter settings from the registry
     2.1 Initialize adapterExtension with AHCI abar
     2.2 Initialize adapterExtension with version & cap values
     3.1 Turn on AE, reset the controller if AE is already set
@@ -499,6 +527,28 @@ Note:
         adapterExtension->LogFlags = dumpContext->LogFlags;
     }
 
+  //1.3 Read the adapter settings from the registry, Parameters\Device of the service key. Dump mode got them from the dump context above.
+    if (!IsDumpMode(adapterExtension)) {
+        ULONG   registryLength = sizeof(ULONG);
+        PUCHAR  registryBuffer = StorPortAllocateRegistryBuffer(adapterExtension, &registryLength);
+
+        if (registryBuffer != NULL) {
+            registryLength = sizeof(ULONG);
+            if (StorPortRegistryRead(adapterExtension,
+                                     (PUCHAR)"DisableDpcRedirectionCurrentCpu",
+                                     1,
+                                     MINIPORT_REG_DWORD,
+                                     registryBuffer,
+                                     &registryLength) &&
+                (registryLength == sizeof(ULONG)) &&
+                (*(PULONG)registryBuffer != 0)) {
+                adapterExtension->RegistryFlags.NoDpcRedirectionCurrentCpu = 1;
+            }
+
+            StorPortFreeRegistryBuffer(adapterExtension, registryBuffer);
+        }
+    }
+
   //2.1 Initialize adapterExtension with AHCI abar
     abar = GetABARAddress(adapterExtension, ConfigInfo);
 
@@ -795,24 +845,34 @@ AhciHwInitialize (
     status = StorPortInitializePerfOpts(AdapterExtension, TRUE, &perfConfigData);
 
     //
-    // Turn on DPC Redirection if it's supported.
+    // Turn on DPC Redirection if it's supported. When StorPort can also steer the
+    // completion DPC to the processor that issued the request, ask for that so the
+    // SRB extension is still warm in that processor's cache at completion time.
     //
     // TODO : Revisit this : Disable these perf optimizations for now during bringup.
 #if !defined (_ARM64_) 
     if ((status == STOR_STATUS_SUCCESS) &&
         ((perfConfigData.Flags & STOR_PERF_DPC_REDIRECTION) != 0)) {
 
+        ULONG supportedFlags = perfConfigData.Flags;
+
         AhciZeroMemory((PCHAR)&perfConfigData, sizeof(PERF_CONFIGURATION_DATA));
         perfConfigData.Version = STOR_PERF_VERSION;
         perfConfigData.Size = sizeof(PERF_CONFIGURATION_DATA);
 
         perfConfigData.Flags = STOR_PERF_DPC_REDIRECTION;
 
+        if (((supportedFlags & STOR_PERF_DPC_REDIRECTION_CURRENT_CPU) != 0) &&
+            (adapterExtension->RegistryFlags.NoDpcRedirectionCurrentCpu == 0)) {
+            perfConfigData.Flags |= STOR_PERF_DPC_REDIRECTION_CURRENT_CPU;
+        }
+
         if (adapterExtension->StateFlags.InterruptMessagePerPort == 1) {
             //
             // Limit interrupt redirection to useful messages only.
             //
-            if (adapterExtension->MessageGroupAffinity != NULL) {
+            if ((adapterExtension->MessageGroupAffinity != NULL) &&
+                ((supportedFlags & STOR_PERF_INTERRUPT_MESSAGE_RANGES) != 0)) {
                 AhciZeroMemory((PCHAR)adapterExtension->MessageGroupAffinity, sizeof(GROUP_AFFINITY)* (adapterExtension->HighestPort + 1));
 
                 perfConfigData.Flags |= (STOR_PERF_INTERRUPT_MESSAGE_RANGES | STOR_PERF_ADV_CONFIG_LOCALITY);
@@ -1128,6 +1188,15 @@ AhciAdapterRemoval (
                 AdapterExtension->PortExtension[i]->StateFlags.PoFxActive = FALSE;
             }
 
+            if (AdapterExtension->PortExtension[i]->CommandTrace != NULL) {
+                StorPortFreePool(AdapterExtension, AdapterExtension->PortExtension[i]->CommandTrace);
+                AdapterExtension->PortExtension[i]->CommandTrace = NULL;
+            }
+
+            if (AdapterExtension->PortExtension[i]->HybridHeatMap != NULL) {
+                StorPortFreePool(AdapterExtension, AdapterExtension->PortExtension[i]->HybridHeatMap);
+                AdapterExtension->PortExtension[i]->HybridHeatMap = NULL;
+            }
 
             AdapterExtension->PortExtension[i] = NULL;
         }
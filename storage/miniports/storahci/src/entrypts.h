@@ -33,6 +33,18 @@ Authors:
 #define AHCI_MAX_LUN                8       //ATAport supports this much in old implementation.
 #define AHCI_MAX_NCQ_REQUEST_COUNT  32
 
+// While at least half of the device queue is in flight, NCQ commands are held in
+// NCQueueSlice until this many are ready, and are issued with one PxSACT/PxCI write.
+#define AHCI_NCQ_DOORBELL_BATCH     4
+
+// Hybrid (SSHD) hot LBA tracking. The user addressable LBA range is split into
+// AHCI_HYBRID_HEAT_BUCKET_COUNT buckets, and every NCQ read or write adds to the heat of
+// its bucket. All heat halves every AHCI_HYBRID_HEAT_DECAY_INTERVAL commands.
+#define AHCI_HYBRID_HEAT_BUCKET_COUNT       1024    // must be a power of 2
+#define AHCI_HYBRID_HEAT_DECAY_INTERVAL     8192
+#define AHCI_HYBRID_HEAT_PROMOTE_THRESHOLD  32      // requests to a bucket at least this hot are promoted
+#define AHCI_HYBRID_HEAT_DEMOTE_THRESHOLD   8       // a promoted bucket that cools below this is demoted
+
 #define KB                          (1024)
 #define AHCI_MAX_TRANSFER_LENGTH    (128 * KB)
 #define MAX_SETTINGS_PRESERVED      32
@@ -80,6 +92,9 @@ typedef struct _CHANNEL_REGISTRY_FLAGS {
 // registry flags apply to the whole adapter
 typedef struct _ADAPTER_REGISTRY_FLAGS {
 
+    ULONG NoDpcRedirectionCurrentCpu : 1;   // "DisableDpcRedirectionCurrentCpu" - don't ask StorPort to complete on the issuing CPU
+
+    ULONG Reserved : 15;
     ULONG Reserved2 : 16;
 
 
@@ -200,7 +215,9 @@ typedef struct _ATA_COMMAND_SUPPORTED {
 
     ULONG  SetDateAndTime           : 1;
 
-    ULONG  Reserved                 : 27;
+    ULONG  QueuedTrim               : 1;    // SEND FPDMA QUEUED - DATA SET MANAGEMENT with TRIM
+
+    ULONG  Reserved                 : 26;
 
 } ATA_COMMAND_SUPPORTED, *PATA_COMMAND_SUPPORTED;
 
@@ -401,6 +418,21 @@ typedef struct _STORAHCI_QUEUE {
     ULONG DepthHistory[100];
 } STORAHCI_QUEUE, *PSTORAHCI_QUEUE;
 
+typedef struct _AHCI_HYBRID_HEAT_BUCKET {
+    USHORT Heat;
+    USHORT Epoch : 15;          // heat map Epoch when Heat was last updated
+    USHORT Promoted : 1;        // requests to this bucket are sent with the highest caching priority
+} AHCI_HYBRID_HEAT_BUCKET, *PAHCI_HYBRID_HEAT_BUCKET;
+
+typedef struct _AHCI_HYBRID_HEAT_MAP {
+    ULONG   BucketShift;        // LBA >> BucketShift is the bucket index
+    ULONG   Epoch;              // advanced every AHCI_HYBRID_HEAT_DECAY_INTERVAL commands
+    LONG    CommandCount;
+    ULONG   Promotions;
+    ULONG   Demotions;
+    AHCI_HYBRID_HEAT_BUCKET Bucket[AHCI_HYBRID_HEAT_BUCKET_COUNT];
+} AHCI_HYBRID_HEAT_MAP, *PAHCI_HYBRID_HEAT_MAP;
+
 typedef struct _AHCI_ADAPTER_EXTENSION  AHCI_ADAPTER_EXTENSION, *PAHCI_ADAPTER_EXTENSION;
 
 typedef struct _AHCI_CHANNEL_EXTENSION {
@@ -460,6 +492,15 @@ typedef struct _AHCI_CHANNEL_EXTENSION {
 //Port IO Queue
     STORAHCI_QUEUE          SrbQueue;
 
+    //
+    // Command issue statistics. Average commands per doorbell is CommandsActivated / DoorbellWrites.
+    //
+    struct {
+        ULONGLONG DoorbellWrites;       // Number of PxCI writes
+        ULONGLONG CommandsActivated;    // Number of commands issued by those writes
+        ULONGLONG DeferredActivations;  // Number of times NCQ commands were held for a larger batch
+    } IssueStats;
+
 //IO Completion Queue and DPC
     STORAHCI_QUEUE          CompletionQueue;
     STOR_DPC                CompletionDpc;
@@ -486,6 +527,13 @@ typedef struct _AHCI_CHANNEL_EXTENSION {
     PVOID                   WorkerTimer;            // used for LPM management for now
     PVOID                   BusChangeTimer;         // used to manage bus change processing
 
+//Command trace, AHCI_COMMAND_TRACE_ENTRY_COUNT entries. Not allocated in dump mode.
+    PAHCI_COMMAND_TRACE_ENTRY CommandTrace;
+    ULONGLONG               CommandTraceCount;      // total commands traced; the next entry is CommandTraceCount % AHCI_COMMAND_TRACE_ENTRY_COUNT
+
+//Hybrid hot LBA tracking. Not allocated in dump mode.
+    PAHCI_HYBRID_HEAT_MAP   HybridHeatMap;
+
 //Logging
     UCHAR                   CommandHistoryNextAvailableIndex;
     COMMAND_HISTORY         CommandHistory[64];
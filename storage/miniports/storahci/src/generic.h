@@ -32,6 +32,7 @@ Revision History:
 // storahci header files
 #include "common.h"
 #include "ahci.h"
+#include "ahcitrace.h"
 #include "entrypts.h"
 #include "pnppower.h"
 #include "hbastat.h"
@@ -407,6 +407,16 @@ Return Values:
             //If there aren't any High Priority, grab everything else
             if (slotsToActivate == 0) {
                 slotsToActivate = ChannelExtension->SlotManager.NCQueueSlice;
+
+                //If the device queue is already deep, hold a small batch of normal priority NCQ IO back.
+                //A completion interrupt is guaranteed as commands are in flight, and it will call ActivateQueue again.
+                if ( (sact != 0) &&
+                     !IsDumpMode(adapterExtension) &&
+                     (NumberOfSetBits(slotsToActivate) < AHCI_NCQ_DOORBELL_BATCH) &&
+                     ((NumberOfSetBits(sact) * 2) >= ChannelExtension->DeviceExtension[0].DeviceParameters.MaxDeviceQueueDepth) ) {
+                    ChannelExtension->IssueStats.DeferredActivations++;
+                    slotsToActivate = 0;
+                }
             }
             //and apply any device outstanding IO limits to filter down which IO to activate
             if (slotsToActivate > 0) {
@@ -428,7 +438,7 @@ Return Values:
   //2.1 Program all the IO from the chosen queue into the controller
     if (slotsToActivate != 0) {
         //2.2 Get command start time
-        if(adapterExtension->TracingEnabled) {
+        if (adapterExtension->TracingEnabled || (ChannelExtension->CommandTrace != NULL)) {
             LARGE_INTEGER perfCounter = {0};
             ULONG pendingProgrammingCommands = slotsToActivate;
 
@@ -449,6 +459,9 @@ Return Values:
 
         ChannelExtension->SlotManager.CommandsIssued |= slotsToActivate;
 
+        ChannelExtension->IssueStats.DoorbellWrites++;
+        ChannelExtension->IssueStats.CommandsActivated += NumberOfSetBits(slotsToActivate);
+
         // program registers
         if (activateNcq) {
             StorPortWriteRegisterUlong(adapterExtension, &ChannelExtension->Px->SACT, slotsToActivate);
@@ -543,6 +556,8 @@ Affected Variables/Registers:
 {
     PSLOT_CONTENT       slotContent;
     UCHAR               i;
+    ULONG               slotIndex;
+    ULONG               validSlots;
 
     PAHCI_ADAPTER_EXTENSION adapterExtension;
     PAHCI_SRB_EXTENSION     srbExtension;
@@ -553,16 +568,28 @@ Affected Variables/Registers:
 
   //1.1 Initialize variables
     adapterExtension = ChannelExtension->AdapterExtension;
+
+    // slots 0 ~ CAP.NCS; NCS == 31 would shift out of the ULONG
+    validSlots = (adapterExtension->CAP.NCS == 31) ? MAXULONG : ((1UL << (adapterExtension->CAP.NCS + 1)) - 1);
+
     if (LogExecuteFullDetail(adapterExtension->LogFlags)) {
         RecordExecutionHistory(ChannelExtension, 0x00000046);//AhciCompleteIssuedSRBs
     }
 
-    if( adapterExtension->TracingEnabled && (ChannelExtension->SlotManager.CommandsToComplete) ) {
+    if( (adapterExtension->TracingEnabled || (ChannelExtension->CommandTrace != NULL)) &&
+        (ChannelExtension->SlotManager.CommandsToComplete) ) {
         StorPortQueryPerformanceCounter((PVOID)adapterExtension, &perfFrequency, &perfCounter);
     }
 
   //2.1 For every command marked as completed
+    //    Skip straight to the next completed slot at or above i, in ascending slot order. CommandsToComplete is
+    //    re-read each time round as ReleaseSlottedCommand can change it.
     for (i = 0; i <= (adapterExtension->CAP.NCS); i++) {
+        if (!BitScanForward(&slotIndex, ChannelExtension->SlotManager.CommandsToComplete & validSlots & ~((1UL << i) - 1))) {
+            break;
+        }
+        i = (UCHAR)slotIndex;
+
         if( ( ChannelExtension->SlotManager.CommandsToComplete & (1 << i) ) > 0) {
             slotContent = &ChannelExtension->Slot[i];
 
@@ -629,6 +656,14 @@ Affected Variables/Registers:
                 ChannelExtension->StateFlags.NCQ_Succeeded = TRUE;
             }
 
+          //2.3.1 Add the command to the command trace, now that its status is final
+            if ( (ChannelExtension->CommandTrace != NULL) &&
+                 (srbExtension->StartTime != 0) &&
+                 (perfCounter.QuadPart != 0) &&
+                 !IsMiniportInternalSrb(ChannelExtension, slotContent->Srb) ) {
+                RecordCommandTrace(ChannelExtension, slotContent, perfCounter.QuadPart, perfFrequency.QuadPart);
+            }
+
           //2.4 Give the slot back
             ReleaseSlottedCommand(ChannelExtension, i, AtDIRQL); // Request sense is handled here.
 
@@ -1135,6 +1135,7 @@ LogPageDiscoveryCompletion (
             PGP_LOG_NCQ_SEND_RECEIVE ncqSendReceive = (PGP_LOG_NCQ_SEND_RECEIVE)ChannelExtension->DeviceExtension->ReadLogExtPageData;
 
             ChannelExtension->DeviceExtension->SupportedCommands.HybridEvict = ncqSendReceive->SubCmd.HybridEvict;
+            ChannelExtension->DeviceExtension->SupportedCommands.QueuedTrim = ncqSendReceive->SubCmd.DataSetManagement & ncqSendReceive->DataSetManagement.Trim;
 
         } else {
             NT_ASSERT(FALSE);
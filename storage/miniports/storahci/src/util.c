@@ -206,6 +206,170 @@ Return Value:
     ChannelExtension->ExecutionHistory[ChannelExtension->ExecutionHistoryNextAvailableIndex].Px[14] = PxCI;
 }
 
+VOID
+RecordCommandTrace(
+    PAHCI_CHANNEL_EXTENSION ChannelExtension,
+    PSLOT_CONTENT SlotContent,
+    ULONGLONG CompletionTime,
+    ULONGLONG CounterFrequency
+  )
+/*++
+    Adds a completed command to the port's command trace. Unlike the execution history
+    this does not read any register, so it is left on in production.
+It assumes:
+    Called with the port interrupt lock held, StartTime has been set by ActivateQueue
+Called by:
+    AhciCompleteIssuedSRBs
+
+Affected Variables/Registers:
+    none
+Return Value:
+    none
+--*/
+{
+    PAHCI_SRB_EXTENSION         srbExtension = GetSrbExtension(SlotContent->Srb);
+    PAHCI_COMMAND_TABLE         cmdTable = (PAHCI_COMMAND_TABLE)srbExtension;
+    PAHCI_COMMAND_TRACE_ENTRY   entry;
+    ULONGLONG                   duration;
+
+    entry = &ChannelExtension->CommandTrace[ChannelExtension->CommandTraceCount & (AHCI_COMMAND_TRACE_ENTRY_COUNT - 1)];
+    ChannelExtension->CommandTraceCount++;
+
+    duration = CalculateTimeDurationIn100ns((CompletionTime - srbExtension->StartTime), CounterFrequency);
+
+    entry->StartTime = srbExtension->StartTime;
+    entry->Duration = (duration > MAXULONG) ? MAXULONG : (ULONG)duration;
+    entry->DataTransferLength = RequestGetDataTransferLength(SlotContent->Srb);
+    entry->Tag = srbExtension->QueueTag;
+    entry->SrbStatus = SlotContent->Srb->SrbStatus;
+    entry->Flags = 0;
+
+    if (IsNCQCommand(srbExtension)) {
+        entry->Flags |= AHCI_COMMAND_TRACE_FLAG_NCQ;
+    }
+
+    if (IsAtapiCommand(srbExtension->AtaFunction) && (SrbGetCdb(SlotContent->Srb) != NULL)) {
+        entry->Flags |= AHCI_COMMAND_TRACE_FLAG_ATAPI;
+        entry->Command = SrbGetCdb(SlotContent->Srb)->CDB6GENERIC.OperationCode;
+    } else {
+        entry->Command = cmdTable->CFIS.Command;
+    }
+}
+
+VOID
+HybridHeatMapReset(
+    PAHCI_CHANNEL_EXTENSION ChannelExtension
+  )
+/*++
+    Clears the hot LBA tracking and sizes the buckets to the device capacity.
+It assumes:
+    IDENTIFY DATA has been retrieved from device and MaxLba is set
+Called by:
+    UpdateDeviceParameters
+
+Affected Variables/Registers:
+    ChannelExtension->HybridHeatMap
+Return Value:
+    none
+--*/
+{
+    PAHCI_HYBRID_HEAT_MAP   heatMap = ChannelExtension->HybridHeatMap;
+    ULONG64                 maxLba;
+
+    if (heatMap == NULL) {
+        return;
+    }
+
+    AhciZeroMemory((PCHAR)heatMap, sizeof(AHCI_HYBRID_HEAT_MAP));
+
+    maxLba = MaxUserAddressableLba(&ChannelExtension->DeviceExtension->DeviceParameters);
+
+    while ((heatMap->BucketShift < 63) && ((maxLba >> heatMap->BucketShift) >= AHCI_HYBRID_HEAT_BUCKET_COUNT)) {
+        heatMap->BucketShift++;
+    }
+}
+
+BOOLEAN
+HybridHeatMapUpdate(
+    PAHCI_CHANNEL_EXTENSION ChannelExtension,
+    ULONG64 StartingLba,
+    PUCHAR Priority
+  )
+/*++
+    Adds a read or write to the heat of its LBA bucket and decides the caching priority
+    the command should carry. Heat is decayed lazily: a bucket is halved once for every
+    epoch that passed since it was last touched, so no timer has to walk the map.
+
+    A bucket that gets hot is promoted, and its requests carry the highest priority the
+    device supports until it cools down. The first request after that carries priority 0,
+    which demotes the range on the caching medium.
+It assumes:
+    Called from AhciHwStartIo without the port interrupt lock. Two requests racing on the
+    same bucket can lose a count, which only makes the heat slightly less accurate.
+Called by:
+    BuildReadWriteCommand
+
+Affected Variables/Registers:
+    ChannelExtension->HybridHeatMap
+Return Value:
+    TRUE if Priority should be sent with the command.
+--*/
+{
+    PAHCI_HYBRID_HEAT_MAP       heatMap = ChannelExtension->HybridHeatMap;
+    PAHCI_HYBRID_HEAT_BUCKET    bucket;
+    ULONG64                     index;
+    ULONG                       epoch;
+    ULONG                       age;
+    ULONG                       heat;
+
+    index = StartingLba >> heatMap->BucketShift;
+
+    // the upper layers could still send us sectors beyond the end of the disk.
+    if (index >= AHCI_HYBRID_HEAT_BUCKET_COUNT) {
+        index = AHCI_HYBRID_HEAT_BUCKET_COUNT - 1;
+    }
+
+    bucket = &heatMap->Bucket[index];
+
+    if ((InterlockedIncrement(&heatMap->CommandCount) % AHCI_HYBRID_HEAT_DECAY_INTERVAL) == 0) {
+        InterlockedIncrement((LONG volatile *)&heatMap->Epoch);
+    }
+
+    epoch = heatMap->Epoch & 0x7FFF;
+    age = (epoch - bucket->Epoch) & 0x7FFF;
+
+    heat = (age >= 16) ? 0 : (bucket->Heat >> age);
+
+    if (heat < MAXUSHORT) {
+        heat++;
+    }
+
+    bucket->Heat = (USHORT)heat;
+    bucket->Epoch = (USHORT)epoch;
+
+    if (heat >= AHCI_HYBRID_HEAT_PROMOTE_THRESHOLD) {
+        if (bucket->Promoted == 0) {
+            bucket->Promoted = 1;
+            heatMap->Promotions++;
+        }
+        *Priority = ChannelExtension->DeviceExtension->HybridInfo.MaximumHybridPriorityLevel;
+        return TRUE;
+    }
+
+    if (bucket->Promoted == 1) {
+        if (heat < AHCI_HYBRID_HEAT_DEMOTE_THRESHOLD) {
+            bucket->Promoted = 0;
+            heatMap->Demotions++;
+            *Priority = 0;
+        } else {
+            *Priority = ChannelExtension->DeviceExtension->HybridInfo.MaximumHybridPriorityLevel;
+        }
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
 VOID
 Set_PxIE(
     PAHCI_CHANNEL_EXTENSION ChannelExtension,
@@ -1005,6 +1005,26 @@ RecordInterruptHistory(
     ULONG Function
   );
 
+VOID
+RecordCommandTrace(
+    PAHCI_CHANNEL_EXTENSION ChannelExtension,
+    PSLOT_CONTENT SlotContent,
+    ULONGLONG CompletionTime,
+    ULONGLONG CounterFrequency
+  );
+
+VOID
+HybridHeatMapReset(
+    PAHCI_CHANNEL_EXTENSION ChannelExtension
+  );
+
+BOOLEAN
+HybridHeatMapUpdate(
+    PAHCI_CHANNEL_EXTENSION ChannelExtension,
+    ULONG64 StartingLba,
+    PUCHAR Priority
+  );
+
 VOID
 Set_PxIE(
     PAHCI_CHANNEL_EXTENSION ChannelExtension,
@@ -1136,6 +1156,19 @@ IsNCQSupported(
     return FALSE;
 }
 
+BOOLEAN
+__inline
+IsDeviceSupportsQueuedTrim (
+    _In_ PAHCI_CHANNEL_EXTENSION ChannelExtension
+    )
+{
+    // NCQ Send and Receive log (13h): DSM subcommand with TRIM is supported, and NCQ is in use on the port.
+    return ( IsDeviceSupportsTrim(ChannelExtension) &&
+             IsNCQSupported(ChannelExtension) &&
+             (ChannelExtension->StateFlags.NCQ_Activated == 1) &&
+             (ChannelExtension->DeviceExtension[0].SupportedCommands.QueuedTrim == 1) );
+}
+
 __inline
 BOOLEAN
 IsFirmwareUpdateSupported(
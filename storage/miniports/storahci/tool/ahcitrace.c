@@ -0,0 +1,251 @@
+/*++
+
+Copyright (C) Microsoft Corporation, 2009
+
+Module Name:
+
+    ahcitrace.c
+
+Abstract:
+
+    Reads the command trace of a StorAHCI port and prints the command latency
+    distribution for each ATA command (or SCSI operation code for ATAPI).
+
+    Usage: ahcitrace <scsi adapter number> <ahci port number>
+
+Environment:
+
+    Win32 console application
+
+--*/
+#include <windows.h>
+#include <winioctl.h>
+#include <ntddscsi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "..\src\ahcitrace.h"
+
+//
+// Latency buckets are powers of 2 microseconds: <1us, <2us, <4us ... >= 2^(BUCKET_COUNT-2)us.
+//
+#define BUCKET_COUNT    24
+
+typedef struct _COMMAND_STATISTICS {
+    ULONG       Count;
+    ULONG       Errors;
+    ULONGLONG   TotalTime;      // in 100ns units
+    ULONG       MaxTime;        // in 100ns units
+    ULONG       Buckets[BUCKET_COUNT];
+} COMMAND_STATISTICS, *PCOMMAND_STATISTICS;
+
+typedef struct _TRACE_BUFFER {
+    SRB_IO_CONTROL              SrbControl;
+    AHCI_COMMAND_TRACE_QUERY    Query;
+} TRACE_BUFFER, *PTRACE_BUFFER;
+
+// indexed by [ATAPI][Command]
+COMMAND_STATISTICS Statistics[2][256];
+
+
+ULONG
+LatencyBucket(
+    _In_ ULONG Duration
+    )
+{
+    ULONG microseconds = Duration / 10;
+    ULONG bucket = 0;
+
+    while ((microseconds != 0) && (bucket < (BUCKET_COUNT - 1))) {
+        microseconds >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+ULONG
+BucketPercentile(
+    _In_ PCOMMAND_STATISTICS CommandStatistics,
+    _In_ ULONG Percent
+    )
+/*++
+    Returns the upper bound, in microseconds, of the bucket holding the given percentile.
+--*/
+{
+    ULONG threshold = (ULONG)(((ULONGLONG)CommandStatistics->Count * Percent + 99) / 100);
+    ULONG sum = 0;
+    ULONG i;
+
+    for (i = 0; i < BUCKET_COUNT; i++) {
+        sum += CommandStatistics->Buckets[i];
+        if (sum >= threshold) {
+            break;
+        }
+    }
+
+    return (i == 0) ? 1 : (1 << i);
+}
+
+VOID
+PrintStatistics(
+    VOID
+    )
+{
+    PCOMMAND_STATISTICS commandStatistics;
+    ULONG atapi;
+    ULONG command;
+    ULONG i;
+
+    //
+    // Percentiles are the upper bound of the bucket they fall in.
+    //
+    printf("%-6s %-7s %8s %8s %10s %10s %10s %10s\n",
+           "Type", "Command", "Count", "Errors", "Avg(us)", "P50<(us)", "P99<(us)", "Max(us)");
+
+    for (atapi = 0; atapi < 2; atapi++) {
+        for (command = 0; command < 256; command++) {
+            commandStatistics = &Statistics[atapi][command];
+
+            if (commandStatistics->Count == 0) {
+                continue;
+            }
+
+            printf("%-6s 0x%02X    %8u %8u %10I64u %10u %10u %10u\n",
+                   atapi ? "SCSI" : "ATA",
+                   command,
+                   commandStatistics->Count,
+                   commandStatistics->Errors,
+                   (commandStatistics->TotalTime / commandStatistics->Count) / 10,
+                   BucketPercentile(commandStatistics, 50),
+                   BucketPercentile(commandStatistics, 99),
+                   commandStatistics->MaxTime / 10);
+        }
+    }
+
+    printf("\nLatency distribution (count per bucket, us):\n");
+
+    for (atapi = 0; atapi < 2; atapi++) {
+        for (command = 0; command < 256; command++) {
+            commandStatistics = &Statistics[atapi][command];
+
+            if (commandStatistics->Count == 0) {
+                continue;
+            }
+
+            printf("%s 0x%02X:", atapi ? "SCSI" : "ATA", command);
+
+            for (i = 0; i < BUCKET_COUNT; i++) {
+                if (commandStatistics->Buckets[i] != 0) {
+                    printf(" <%u:%u", (1 << i), commandStatistics->Buckets[i]);
+                }
+            }
+
+            printf("\n");
+        }
+    }
+}
+
+int __cdecl
+main(
+    _In_ ULONG argc,
+    _In_reads_(argc) PCHAR argv[]
+    )
+{
+    HANDLE hDevice;
+    BOOL bRc;
+    ULONG bytesReturned = 0;
+    CHAR deviceName[32];
+    PTRACE_BUFFER traceBuffer;
+    PAHCI_COMMAND_TRACE_ENTRY entry;
+    PCOMMAND_STATISTICS commandStatistics;
+    ULONG i;
+
+    if (argc != 3) {
+        printf("Usage: ahcitrace <scsi adapter number> <ahci port number>\n");
+        return 1;
+    }
+
+    sprintf_s(deviceName, sizeof(deviceName), "\\\\.\\Scsi%u:", strtoul(argv[1], NULL, 10));
+
+    hDevice = CreateFile(deviceName,
+                         GENERIC_READ | GENERIC_WRITE,
+                         FILE_SHARE_READ | FILE_SHARE_WRITE,
+                         NULL,
+                         OPEN_EXISTING,
+                         0,
+                         NULL);
+
+    if (hDevice == INVALID_HANDLE_VALUE) {
+        printf("Error opening %s: %u\n", deviceName, GetLastError());
+        return 1;
+    }
+
+    traceBuffer = (PTRACE_BUFFER)calloc(1, sizeof(TRACE_BUFFER));
+
+    if (traceBuffer == NULL) {
+        printf("Out of memory\n");
+        CloseHandle(hDevice);
+        return 1;
+    }
+
+    traceBuffer->SrbControl.HeaderLength = sizeof(SRB_IO_CONTROL);
+    memcpy(traceBuffer->SrbControl.Signature, STORAHCI_TRACE_SIGNATURE, sizeof(traceBuffer->SrbControl.Signature));
+    traceBuffer->SrbControl.Timeout = 30;
+    traceBuffer->SrbControl.ControlCode = IOCTL_STORAHCI_QUERY_COMMAND_TRACE;
+    traceBuffer->SrbControl.Length = sizeof(AHCI_COMMAND_TRACE_QUERY);
+
+    traceBuffer->Query.Version = AHCI_COMMAND_TRACE_QUERY_VERSION;
+    traceBuffer->Query.PortNumber = strtoul(argv[2], NULL, 10);
+
+    bRc = DeviceIoControl(hDevice,
+                          IOCTL_SCSI_MINIPORT,
+                          traceBuffer,
+                          sizeof(TRACE_BUFFER),
+                          traceBuffer,
+                          sizeof(TRACE_BUFFER),
+                          &bytesReturned,
+                          NULL);
+
+    CloseHandle(hDevice);
+
+    if (!bRc) {
+        printf("Error querying the command trace: %u\n", GetLastError());
+        free(traceBuffer);
+        return 1;
+    }
+
+    if (traceBuffer->Query.EntryCount > AHCI_COMMAND_TRACE_ENTRY_COUNT) {
+        printf("Unexpected entry count %u\n", traceBuffer->Query.EntryCount);
+        free(traceBuffer);
+        return 1;
+    }
+
+    for (i = 0; i < traceBuffer->Query.EntryCount; i++) {
+        entry = &traceBuffer->Query.Entries[i];
+        commandStatistics = &Statistics[(entry->Flags & AHCI_COMMAND_TRACE_FLAG_ATAPI) ? 1 : 0][entry->Command];
+
+        commandStatistics->Count++;
+        commandStatistics->TotalTime += entry->Duration;
+        commandStatistics->Buckets[LatencyBucket(entry->Duration)]++;
+
+        if (entry->Duration > commandStatistics->MaxTime) {
+            commandStatistics->MaxTime = entry->Duration;
+        }
+
+        // SRB_STATUS_SUCCESS
+        if ((entry->SrbStatus & 0x3F) != 0x01) {
+            commandStatistics->Errors++;
+        }
+    }
+
+    printf("Port %u: %u of %I64u commands traced\n\n",
+           traceBuffer->Query.PortNumber,
+           traceBuffer->Query.EntryCount,
+           traceBuffer->Query.TotalCommands);
+
+    PrintStatistics();
+
+    free(traceBuffer);
+    return 0;
+}
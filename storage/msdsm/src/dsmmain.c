@@ -381,6 +381,7 @@ Return Value:
         group->GroupNumber = InterlockedIncrement((LONG volatile*)&DsmContext->NumberGroups);
         group->GroupSig = DSM_GROUP_SIG;
         group->State = DSM_GP_NORMAL;
+        group->ActivePathSet.Stale = TRUE;
 
         //
         // Add it to the list of multi-path groups.
@@ -3302,6 +3303,522 @@ DsmpDecrementCounters(
 }
 
 
+ULONG_PTR
+DsmpGetServiceTimeStamp(
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Returns the current interrupt time in microseconds. Only the difference of
+    two time stamps is meaningful, so truncating to ULONG_PTR is fine.
+
+--*/
+{
+    return (ULONG_PTR)(KeQueryInterruptTime() / 10);
+}
+
+
+ULONG
+DsmpUpdateServiceTime(
+    _In_ PDSM_FAILOVER_GROUP FailGroup,
+    _In_ PSCSI_REQUEST_BLOCK Srb,
+    _In_ ULONG_PTR StartTime
+    )
+/*++
+
+Routine Description:
+
+    Folds the latency of a completed read/write request into the path's moving
+    average of service time, used by the Least Service Time policy.
+
+    The update is not serialized with other completions on the same path. A lost
+    sample only delays convergence of the average, so no lock is taken here.
+
+Arguments:
+
+    FailGroup - The path the request was sent down.
+    Srb - The completed request.
+    StartTime - Time stamp taken when the request was dispatched down the path.
+
+Return Value:
+
+    The latency of the request in microseconds, 0 if it wasn't measured.
+
+--*/
+{
+    PCDB cdb = NULL;
+    LONGLONG sample;
+    LONGLONG average;
+
+    if (!Srb || StartTime == 0 || SRB_STATUS(Srb->SrbStatus) != SRB_STATUS_SUCCESS) {
+
+        return 0;
+    }
+
+    cdb = SrbGetCdb(Srb);
+
+    if (!(cdb && DsmIsReadWrite(cdb->AsByte[0]))) {
+
+        return 0;
+    }
+
+    sample = (LONGLONG)(DsmpGetServiceTimeStamp() - StartTime);
+
+    if (sample <= 0) {
+
+        sample = 1;
+
+    } else if (sample > MAXLONG) {
+
+        sample = MAXLONG;
+    }
+
+    average = InterlockedCompareExchange(&FailGroup->AverageServiceTime, 0, 0);
+
+    if (average == 0) {
+
+        //
+        // First sample on this path.
+        //
+        average = sample;
+
+    } else {
+
+        average += (sample - average) / (1 << DSM_SERVICE_TIME_EWMA_SHIFT);
+
+        if (average <= 0) {
+            average = 1;
+        }
+    }
+
+    InterlockedExchange(&FailGroup->AverageServiceTime, (LONG)average);
+
+    return (ULONG)sample;
+}
+
+
+VOID
+DsmpUpdateLBPolicyStats(
+    _In_ PDSM_GROUP_ENTRY Group,
+    _In_ PSCSI_REQUEST_BLOCK Srb,
+    _In_ ULONG ServiceTime
+    )
+/*++
+
+Routine Description:
+
+    Accounts a completed read/write request to the group's current load
+    balance policy, so that the throughput of the policies can be compared.
+
+Arguments:
+
+    Group - The multi-path group.
+    Srb - The completed request.
+    ServiceTime - Completion latency of the request in microseconds.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PCDB cdb = NULL;
+    PDSM_LB_STATS lbStats;
+
+    if (!Group || !Srb || SRB_STATUS(Srb->SrbStatus) != SRB_STATUS_SUCCESS) {
+
+        return;
+    }
+
+    cdb = SrbGetCdb(Srb);
+
+    if (!(cdb && DsmIsReadWrite(cdb->AsByte[0]))) {
+
+        return;
+    }
+
+    if (Group->LoadBalanceType < DSM_LB_FAILOVER ||
+        Group->LoadBalanceType > DSM_NUMBER_OF_LB_POLICIES) {
+
+        return;
+    }
+
+    lbStats = &Group->LBStats[Group->LoadBalanceType - 1];
+
+    InterlockedIncrement64((LONGLONG volatile*)&lbStats->NumberRequests);
+    InterlockedExchangeAdd64((LONGLONG volatile*)&lbStats->BytesTransferred, SrbGetDataTransferLength(Srb));
+    InterlockedExchangeAdd64((LONGLONG volatile*)&lbStats->TotalServiceTime, ServiceTime);
+
+    return;
+}
+
+
+BOOLEAN
+DsmpGetRequestLbaRange(
+    _In_ PSCSI_REQUEST_BLOCK Srb,
+    _Out_ PULONGLONG StartLba,
+    _Out_ PULONG NumberBlocks
+    )
+/*++
+
+Routine Description:
+
+    Extracts the starting LBA and the block count of a read/write request.
+
+Arguments:
+
+    Srb - The request.
+    StartLba - Returns the first LBA of the request.
+    NumberBlocks - Returns the number of blocks of the request.
+
+Return Value:
+
+    TRUE if the request is a read or a write.
+
+--*/
+{
+    PCDB cdb = NULL;
+
+    *StartLba = 0;
+    *NumberBlocks = 0;
+
+    if (!Srb) {
+
+        return FALSE;
+    }
+
+    cdb = SrbGetCdb(Srb);
+
+    if (!(cdb && DsmIsReadWrite(cdb->AsByte[0]))) {
+
+        return FALSE;
+    }
+
+    if (SrbGetCdbLength(Srb) == 16) {
+
+        REVERSE_BYTES_QUAD(StartLba, &cdb->CDB16.LogicalBlock);
+        REVERSE_BYTES(NumberBlocks, &cdb->CDB16.TransferLength);
+
+    } else {
+
+        REVERSE_BYTES(StartLba, &cdb->CDB10.LogicalBlockByte0);
+        REVERSE_BYTES_SHORT(NumberBlocks, &cdb->CDB10.TransferBlocksMsb);
+    }
+
+    return TRUE;
+}
+
+
+PDSM_FAILOVER_GROUP
+DsmpGetStreamAffinityPath(
+    _In_ PDSM_GROUP_ENTRY Group,
+    _In_ PDSM_IDS DsmList,
+    _In_ PSCSI_REQUEST_BLOCK Srb
+    )
+/*++
+
+Routine Description:
+
+    Used by the Round Robin policies when stream affinity is enabled. If the
+    request continues the LUN's current sequential run, and the run hasn't
+    reached the threshold yet, it is kept on the run's path so that the
+    storage's read-ahead isn't defeated by striping the run across paths.
+
+Arguments:
+
+    Group - The multi-path group.
+    DsmList - List of DSM Ids sent by MPIO.
+    Srb - The read/write request.
+
+Return Value:
+
+    The run's path if it should be used, NULL to round robin as usual.
+
+--*/
+{
+    PDSM_FAILOVER_GROUP streamPath = Group->Stream.Path;
+    PDSM_DEVICE_INFO deviceInfo;
+    ULONGLONG startLba;
+    ULONG numberBlocks;
+    ULONG bytes;
+    ULONG inx;
+
+    if (!streamPath || !DsmpGetRequestLbaRange(Srb, &startLba, &numberBlocks)) {
+
+        return NULL;
+    }
+
+    bytes = SrbGetDataTransferLength(Srb);
+
+    if (startLba != Group->Stream.NextLba ||
+        Group->Stream.Bytes + bytes > Group->StreamAffinityThreshold) {
+
+        return NULL;
+    }
+
+    //
+    // The run's path must still be usable.
+    //
+    for (inx = 0; inx < DsmList->Count; inx++) {
+
+        deviceInfo = DsmList->IdList[inx];
+
+        if (!(deviceInfo && deviceInfo->FailGroup == streamPath)) {
+
+            continue;
+        }
+
+        if (DsmpIsDeviceInitialized(deviceInfo) &&
+            DsmpIsDeviceUsable(deviceInfo) &&
+            DsmpIsDeviceUsablePR(deviceInfo) &&
+            deviceInfo->State == DSM_DEV_ACTIVE_OPTIMIZED) {
+
+            Group->Stream.NextLba = startLba + numberBlocks;
+            Group->Stream.Bytes += bytes;
+
+            if (Group->LoadBalanceType >= DSM_LB_FAILOVER &&
+                Group->LoadBalanceType <= DSM_NUMBER_OF_LB_POLICIES) {
+
+                InterlockedIncrement64((LONGLONG volatile*)&Group->LBStats[Group->LoadBalanceType - 1].StreamAffinityRequests);
+            }
+
+            TracePrint((TRACE_LEVEL_VERBOSE,
+                        TRACE_FLAG_RW,
+                        "DsmpGetStreamAffinityPath (Group %p): Sequential IO, so using same path %p.\n",
+                        Group,
+                        streamPath));
+
+            return streamPath;
+        }
+
+        break;
+    }
+
+    return NULL;
+}
+
+
+VOID
+DsmpStartStream(
+    _In_ PDSM_GROUP_ENTRY Group,
+    _In_ PDSM_FAILOVER_GROUP FailGroup,
+    _In_ PSCSI_REQUEST_BLOCK Srb
+    )
+/*++
+
+Routine Description:
+
+    Records the request, sent down FailGroup, as the possible start of a new
+    sequential run for DsmpGetStreamAffinityPath.
+
+Arguments:
+
+    Group - The multi-path group.
+    FailGroup - The path chosen for the request.
+    Srb - The read/write request.
+
+Return Value:
+
+    None
+
+--*/
+{
+    ULONGLONG startLba;
+    ULONG numberBlocks;
+
+    if (!DsmpGetRequestLbaRange(Srb, &startLba, &numberBlocks)) {
+
+        return;
+    }
+
+    Group->Stream.Path = FailGroup;
+    Group->Stream.NextLba = startLba + numberBlocks;
+    Group->Stream.Bytes = SrbGetDataTransferLength(Srb);
+
+    return;
+}
+
+
+VOID
+DsmpInvalidateActivePathSet(
+    _In_ PDSM_GROUP_ENTRY Group
+    )
+/*++
+
+Routine Description:
+
+    Marks the group's active path set as stale, so that the next request going
+    through DsmpGetPath rebuilds it. Must be called whenever the states of
+    the group's paths, or its load balance policy, may have changed.
+
+Arguments:
+
+    Group - The multi-path group.
+
+Return Value:
+
+    None
+
+--*/
+{
+    InterlockedExchange(&Group->ActivePathSet.Stale, TRUE);
+}
+
+
+PDSM_FAILOVER_GROUP
+DsmpGetPathFromActivePathSet(
+    _In_ PDSM_GROUP_ENTRY Group,
+    _In_ PDSM_IDS DsmList
+    )
+/*++
+
+Routine Description:
+
+    Picks the next path for the Round Robin policies from the group's active
+    path set, without taking any lock and without writing to data shared by
+    all processors. Each processor keeps its own round robin position.
+
+    If the set is stale it is rebuilt first from the DSM Ids, which are
+    guaranteed to be valid for the duration of the call. Only one processor
+    rebuilds at a time; the others fall back to the regular path walk.
+
+    Every path picked from the set is validated against the DSM Ids and its
+    current state, so a set that is out of date can at worst skip a path that
+    became A/O since the last rebuild.
+
+Arguments:
+
+    Group - The multi-path group.
+    DsmList - List of DSM Ids sent by MPIO.
+
+Return Value:
+
+    The failover group to be used, or NULL if the caller needs to walk the
+    paths itself.
+
+--*/
+{
+    PDSM_ACTIVE_PATH_SET pathSet = &Group->ActivePathSet;
+    PDSM_PATH_CURSOR cursor;
+    PDSM_DEVICE_INFO deviceInfo;
+    LONG sequence;
+    ULONG numberPaths;
+    ULONG start;
+    ULONG inx;
+    ULONG jnx;
+
+    //
+    // Rebuild the set if the path states changed since it was last built.
+    //
+    if (InterlockedCompareExchange(&pathSet->Stale, TRUE, TRUE)) {
+
+        sequence = InterlockedCompareExchange(&pathSet->Sequence, 0, 0);
+
+        if ((sequence & 1) ||
+            InterlockedCompareExchange(&pathSet->Sequence, sequence + 1, sequence) != sequence) {
+
+            return NULL;
+        }
+
+        //
+        // Clear the flag before looking at the states, so that a change made
+        // while the set is being rebuilt marks it stale again.
+        //
+        InterlockedExchange(&pathSet->Stale, FALSE);
+
+        for (inx = 0, numberPaths = 0; inx < DsmList->Count && numberPaths < DSM_MAX_PATHS; inx++) {
+
+            deviceInfo = DsmList->IdList[inx];
+
+            if (deviceInfo &&
+                DsmpIsDeviceInitialized(deviceInfo) &&
+                DsmpIsDeviceUsable(deviceInfo) &&
+                DsmpIsDeviceUsablePR(deviceInfo) &&
+                deviceInfo->State == DSM_DEV_ACTIVE_OPTIMIZED) {
+
+                pathSet->Paths[numberPaths++] = deviceInfo;
+            }
+        }
+
+        pathSet->NumberPaths = numberPaths;
+
+        InterlockedIncrement(&pathSet->Sequence);
+    }
+
+    sequence = InterlockedCompareExchange(&pathSet->Sequence, 0, 0);
+
+    if (sequence & 1) {
+
+        return NULL;
+    }
+
+    numberPaths = pathSet->NumberPaths;
+
+    if (numberPaths == 0 || numberPaths > DSM_MAX_PATHS) {
+
+        return NULL;
+    }
+
+    cursor = &pathSet->Cursor[KeGetCurrentProcessorNumberEx(NULL) % DSM_ACTIVE_PATH_SET_CURSORS];
+    start = cursor->Next;
+
+    for (inx = 0; inx < numberPaths; inx++) {
+
+        deviceInfo = pathSet->Paths[(start + inx) % numberPaths];
+
+        KeMemoryBarrier();
+
+        if (InterlockedCompareExchange(&pathSet->Sequence, 0, 0) != sequence) {
+
+            //
+            // The set was rebuilt under us, the pointer read may be inconsistent.
+            //
+            return NULL;
+        }
+
+        //
+        // Only dereference the devInfo if MPIO gave it to us in this call.
+        //
+        for (jnx = 0; jnx < DsmList->Count; jnx++) {
+
+            if (DsmList->IdList[jnx] == deviceInfo) {
+                break;
+            }
+        }
+
+        if (jnx == DsmList->Count) {
+
+            continue;
+        }
+
+        if (DsmpIsDeviceInitialized(deviceInfo) &&
+            DsmpIsDeviceUsable(deviceInfo) &&
+            DsmpIsDeviceUsablePR(deviceInfo) &&
+            deviceInfo->State == DSM_DEV_ACTIVE_OPTIMIZED) {
+
+            cursor->Next = (start + inx + 1) % numberPaths;
+
+            TracePrint((TRACE_LEVEL_VERBOSE,
+                        TRACE_FLAG_RW,
+                        "DsmpGetPathFromActivePathSet (Group %p): Path to be used is %p.\n",
+                        Group,
+                        deviceInfo->FailGroup));
+
+            return deviceInfo->FailGroup;
+        }
+    }
+
+    //
+    // None of the paths in the set is usable any more.
+    //
+    DsmpInvalidateActivePathSet(Group);
+
+    return NULL;
+}
+
+
 PDSM_FAILOVER_GROUP
 DsmpGetPath(
     _In_ IN PDSM_CONTEXT DsmContext,
@@ -3462,6 +3979,33 @@ Return Value:
             ULONG counter = 0;
             BOOLEAN reset = FALSE;
 
+            //
+            // Keep a sequential run on the path it started on, if enabled.
+            // Otherwise try the lock-free active path set first. Fall back to
+            // walking the paths and updating PathToBeUsed only if it can't be used.
+            //
+            if (groupEntry->UseStreamAffinity) {
+
+                failGroup = DsmpGetStreamAffinityPath(groupEntry, DsmList, Srb);
+
+                if (failGroup) {
+
+                    break;
+                }
+            }
+
+            failGroup = DsmpGetPathFromActivePathSet(groupEntry, DsmList);
+
+            if (failGroup) {
+
+                if (groupEntry->UseStreamAffinity) {
+
+                    DsmpStartStream(groupEntry, failGroup, Srb);
+                }
+
+                break;
+            }
+
             for (inx = 0; inx < DsmList->Count; inx++) {
 
                 deviceInfo = DsmList->IdList[inx];
@@ -3586,6 +4130,11 @@ Return Value:
                 }
             }
 
+            if (failGroup && groupEntry->UseStreamAffinity) {
+
+                DsmpStartStream(groupEntry, failGroup, Srb);
+            }
+
             break;
         }
 
@@ -3660,6 +4209,88 @@ Return Value:
             break;
         }
 
+        case DSM_LB_LEAST_SERVICE_TIME: {
+
+            LONGLONG leastServiceTime = MAXLONGLONG;
+            LONGLONG serviceTime;
+            LONG averageServiceTime;
+
+            //
+            // Choose the Active/Optimized path with the least expected service time,
+            // ie. its average completion latency times the requests queued on it
+            // (including this one). For ALUA storage only paths in an A/O TPG are
+            // considered, as with LQD.
+            //
+            for (inx = 0; inx < DsmList->Count; inx++) {
+
+                deviceInfo = DsmList->IdList[inx];
+
+                if (!(deviceInfo && DsmpIsDeviceInitialized(deviceInfo) && DsmpIsDeviceUsable(deviceInfo) && DsmpIsDeviceUsablePR(deviceInfo))) {
+
+                    continue;
+                }
+
+                if (deviceInfo->State != DSM_DEV_ACTIVE_OPTIMIZED) {
+
+                    continue;
+                }
+
+                //
+                // A path that has not completed a request yet is assumed to be
+                // fast, so that it gets sampled.
+                //
+                averageServiceTime = deviceInfo->FailGroup->AverageServiceTime;
+                if (averageServiceTime <= 0) {
+                    averageServiceTime = 1;
+                }
+
+                serviceTime = (LONGLONG)averageServiceTime * (deviceInfo->FailGroup->NumberOfRequestsInFlight + 1);
+
+                if (serviceTime < leastServiceTime) {
+
+                    leastServiceTime = serviceTime;
+                    failGroup = deviceInfo->FailGroup;
+                }
+            }
+
+            if (failGroup) {
+
+                TracePrint((TRACE_LEVEL_WARNING,
+                            TRACE_FLAG_RW,
+                            "DsmpGetPath (DsmIds %p): Path to be used for LST is %p.\n",
+                            DsmList,
+                            failGroup));
+
+            } else {
+
+                //
+                // Same as for LQD, for ALUA storage left with no TPG in the A/O
+                // state return some path instead of failing the I/O.
+                //
+                if (!DsmpIsSymmetricAccess((PDSM_DEVICE_INFO)DsmList->IdList[0])) {
+
+                    //
+                    // Use the same path as the one used for the previous request.
+                    //
+                    failGroup = groupEntry->PathToBeUsed;
+
+                    TracePrint((TRACE_LEVEL_WARNING,
+                                TRACE_FLAG_PNP,
+                                "DsmpGetPath (DsmIds %p): Using same path (FOG %p) as previous request for LST.\n",
+                                DsmList,
+                                failGroup));
+                } else {
+
+                    TracePrint((TRACE_LEVEL_ERROR,
+                                TRACE_FLAG_RW,
+                                "DsmpGetPath (DsmIds %p): Failed to find a path for LST.\n",
+                                DsmList));
+                }
+            }
+
+            break;
+        }
+
         case DSM_LB_LEAST_BLOCKS: {
 
             ULONG bytes = 0;
@@ -4410,6 +5041,7 @@ Return Value:
     ULONG dataTransferLength = 0;
     PIO_STACK_LOCATION irpStack = IoGetCurrentIrpStackLocation(Irp);
     PDSM_FAILOVER_GROUP failGroup = irpStack->Parameters.Others.Argument3;
+    ULONG serviceTime = 0;
 
     TracePrint((TRACE_LEVEL_VERBOSE,
                 TRACE_FLAG_RW,
@@ -4432,6 +5064,11 @@ Return Value:
 
     if (failGroup) {
 
+        //
+        // Feed the request's latency into the path's average service time.
+        //
+        serviceTime = DsmpUpdateServiceTime(failGroup, Srb, (ULONG_PTR)irpStack->Parameters.Others.Argument4);
+
         if (DsmpDecrementCounters(failGroup, Srb)) {
 
             //
@@ -4486,6 +5123,11 @@ Return Value:
         //
         if (!dsmContext->DisableStatsGathering) {
 
+            //
+            // Account the request to the LUN's current load balance policy.
+            //
+            DsmpUpdateLBPolicyStats(deviceInfo->Group, Srb, serviceTime);
+
             //
             // If it's a read or a write, update the stats.
             // Use the path that was cached during dispatch.
@@ -5083,16 +5725,23 @@ Return Value:
                 "DsmpGetActivePathToBeUsed (Group %p): Entering function.\n",
                 Group));
 
+    //
+    // Path states have (potentially) changed, so the lock-free set of
+    // active paths must be rebuilt.
+    //
+    DsmpInvalidateActivePathSet(Group);
+
     deviceInfo = NULL;
 
     switch (Group->LoadBalanceType) {
 
         case DSM_LB_LEAST_BLOCKS:
-        case DSM_LB_DYN_LEAST_QUEUE_DEPTH: {
+        case DSM_LB_DYN_LEAST_QUEUE_DEPTH:
+        case DSM_LB_LEAST_SERVICE_TIME: {
 
             //
-            // Since we choose the path with the smallest queue or cumulative size in
-            // DsmpGetPath, we just pick any path now
+            // Since we choose the path with the smallest queue, cumulative size or
+            // expected service time in DsmpGetPath, we just pick any path now
             //
 
             // fall through
@@ -6171,10 +6820,11 @@ Return Value:
         case DSM_LB_LEAST_BLOCKS:
         case DSM_LB_ROUND_ROBIN:
         case DSM_LB_DYN_LEAST_QUEUE_DEPTH:
-        case DSM_LB_WEIGHTED_PATHS: {
+        case DSM_LB_WEIGHTED_PATHS:
+        case DSM_LB_LEAST_SERVICE_TIME: {
 
             //
-            // In RR, LWP, LB and LQD all paths are active so the new device
+            // In RR, LWP, LB, LQD and LST all paths are active so the new device
             // becomes AO or AU.
             //
             if (NewDeviceInfo->State != DSM_DEV_ACTIVE_OPTIMIZED) {
@@ -6596,10 +7246,11 @@ Return Value:
         case DSM_LB_LEAST_BLOCKS:
         case DSM_LB_ROUND_ROBIN:
         case DSM_LB_WEIGHTED_PATHS:
-        case DSM_LB_DYN_LEAST_QUEUE_DEPTH: {
+        case DSM_LB_DYN_LEAST_QUEUE_DEPTH:
+        case DSM_LB_LEAST_SERVICE_TIME: {
 
             //
-            // In RR, LQD, LB and LWP, all paths are active so we don't
+            // In RR, LQD, LB, LWP and LST, all paths are active so we don't
             // need to worry about activating a new path
             //
             TracePrint((TRACE_LEVEL_INFORMATION,
@@ -6734,7 +7385,7 @@ Return Value:
     }
 
     if (group->LoadBalanceType < DSM_LB_FAILOVER ||
-        group->LoadBalanceType > DSM_LB_LEAST_BLOCKS) {
+        group->LoadBalanceType > DSM_LB_LEAST_SERVICE_TIME) {
 
         status = STATUS_INVALID_PARAMETER;
 
@@ -6999,7 +7650,7 @@ Return Value:
     group = FailingDeviceInfo->Group;
 
     if (group->LoadBalanceType < DSM_LB_FAILOVER ||
-        group->LoadBalanceType > DSM_LB_LEAST_BLOCKS) {
+        group->LoadBalanceType > DSM_LB_LEAST_SERVICE_TIME) {
 
         status = STATUS_INVALID_PARAMETER;
 
@@ -7378,7 +8029,7 @@ Return Value:
 
 
     if (group->LoadBalanceType < DSM_LB_FAILOVER ||
-        group->LoadBalanceType > DSM_LB_LEAST_BLOCKS) {
+        group->LoadBalanceType > DSM_LB_LEAST_SERVICE_TIME) {
 
         status = STATUS_INVALID_PARAMETER;
 
@@ -530,6 +530,8 @@ Return Value:
     ULONG maxPRRetryTimeDuringStateTransition = DSM_MAX_PR_UNIT_ATTENTION_RETRY_TIME;
     BOOLEAN useCacheForLeastBlocks = FALSE;
     ULONGLONG cacheSizeForLeastBlocks = 0;
+    BOOLEAN useStreamAffinity = FALSE;
+    ULONG streamAffinityThreshold = DSM_STREAM_AFFINITY_DEFAULT_THRESHOLD;
     BOOLEAN fakeControllerEntryExists = FALSE;
     STORAGE_IDENTIFIER_CODE_SET serialNumberCodeSet = StorageIdCodeSetReserved;
 
@@ -970,6 +972,14 @@ Return Value:
         cacheSizeForLeastBlocks = DSM_LEAST_BLOCKS_DEFAULT_THRESHOLD;
     }
 
+    //
+    // Query the registry to see if the user has enabled stream affinity for
+    // the Round Robin policies. On failure the defaults (disabled) are used.
+    //
+    DsmpQueryStreamAffinityFromRegistry(DsmContext,
+                                        &useStreamAffinity,
+                                        &streamAffinityThreshold);
+
     //
     // Build LUN's hardware id.  Needs to be called at PASSIVE_LEVEL, so
     // do it before grabbing the lock.  The hardware id of the group is
@@ -1027,6 +1037,8 @@ Return Value:
 
             group->UseCacheForLeastBlocks = useCacheForLeastBlocks;
             group->CacheSizeForLeastBlocks = cacheSizeForLeastBlocks;
+            group->UseStreamAffinity = useStreamAffinity;
+            group->StreamAffinityThreshold = streamAffinityThreshold;
 
         } else {
 
@@ -3237,6 +3249,7 @@ Return Value:
                 if (deviceInfo->State == DSM_DEV_ACTIVE_OPTIMIZED) {
 
                     InterlockedExchangePointer(&(group->PathToBeUsed), (PVOID)failGroup);
+                    DsmpInvalidateActivePathSet(group);
                     status = STATUS_SUCCESS;
                 }
             }
@@ -3766,6 +3779,7 @@ Return Value:
                 }
 
                 irpStack->Parameters.Others.Argument3 = failGroup;
+                irpStack->Parameters.Others.Argument4 = (PVOID)DsmpGetServiceTimeStamp();
 
                 DsmpIncrementCounters(failGroup, Srb);
             }
@@ -4164,6 +4178,11 @@ Return Value:
     //
     irpStack->Parameters.Others.Argument3 = failGroup;
 
+    //
+    // Stamp the dispatch time in Argument4 for the path's service time average.
+    //
+    irpStack->Parameters.Others.Argument4 = (PVOID)DsmpGetServiceTimeStamp();
+
     DsmpIncrementCounters(failGroup, Srb);
 
     if (!dsmContext->DisableStatsGathering) {
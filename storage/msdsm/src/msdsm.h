@@ -71,6 +71,14 @@ Notes:
 #define DSM_USE_CACHE_FOR_LEAST_BLOCKS          L"DsmUseCacheForLeastBlocks"
 #define DSM_CACHE_SIZE_FOR_LEAST_BLOCKS         L"DsmCacheSizeForLeastBlocks"
 
+//
+// Names of the values in the registry for whether to keep sequential runs on
+// one path when employing the Round Robin load balance policies, as well as
+// the number of bytes after which a run moves on to the next path.
+//
+#define DSM_USE_STREAM_AFFINITY_FOR_ROUND_ROBIN L"DsmUseStreamAffinityForRoundRobin"
+#define DSM_STREAM_AFFINITY_THRESHOLD           L"DsmStreamAffinityThreshold"
+
 //
 // Name of the value in the registry for the maximum request retry time during ALUA
 // state transitions. This value is found in the DSM's Services' Parameters key, and
@@ -99,7 +107,26 @@ Notes:
 //
 // Number of LB Policies that are supported by this driver.
 //
-#define DSM_NUMBER_OF_LB_POLICIES 6
+#define DSM_NUMBER_OF_LB_POLICIES 7
+
+//
+// Least Service Time load balance policy. The MPIO interfaces reserve the
+// vendor specific policy value for DSM-defined policies, so MSDSM reports its
+// own latency-aware policy through it.
+//
+#define DSM_LB_LEAST_SERVICE_TIME DSM_LB_VENDOR_SPECIFIC
+
+//
+// The Least Service Time policy keeps a moving average of completion latency
+// per path. Each new sample gets a weight of 1 / (1 << shift), ie. 1/8.
+//
+#define DSM_SERVICE_TIME_EWMA_SHIFT 3
+
+//
+// Number of round robin cursors kept per group for the active path set.
+// Processors map onto the cursors modulo this value.
+//
+#define DSM_ACTIVE_PATH_SET_CURSORS 16
 
 //
 // Size of the buffer passed to read in Persistent Reserve keys.
@@ -112,6 +139,12 @@ Notes:
 //
 #define DSM_LEAST_BLOCKS_DEFAULT_THRESHOLD 0x00100000
 
+//
+// The default number of bytes of a sequential run that the Round Robin
+// policies keep on one path, when stream affinity is enabled, is 1MB.
+//
+#define DSM_STREAM_AFFINITY_DEFAULT_THRESHOLD 0x00100000
+
 //
 // Initialization data structure that needs to be filled in for MPIO
 //
@@ -632,6 +665,40 @@ typedef struct _DSM_STATS {
 
 } DSM_STATS, *PDSM_STATS;
 
+//
+// Per load balance policy counters of a multi-path group.
+//
+typedef struct _DSM_LB_STATS {
+
+    ULONGLONG  NumberRequests;
+    ULONGLONG  BytesTransferred;
+    ULONGLONG  TotalServiceTime;
+    ULONGLONG  StreamAffinityRequests;
+
+} DSM_LB_STATS, *PDSM_LB_STATS;
+
+//
+// The sequential run last seen on a multi-path group.
+//
+typedef struct _DSM_STREAM {
+
+    //
+    // The LBA a request must start at to continue the run.
+    //
+    ULONGLONG NextLba;
+
+    //
+    // The path the run is being sent down.
+    //
+    PVOID Path;
+
+    //
+    // Bytes of the run sent down Path so far.
+    //
+    ULONG Bytes;
+
+} DSM_STREAM, *PDSM_STREAM;
+
 
 //
 // Information about each device that is supported by the DSM.
@@ -832,6 +899,42 @@ typedef ULONG   DSM_LOAD_BALANCE_TYPE, *PDSM_LOAD_BALANCE_TYPE;
 // are put under one group. Each group will have it's own Load Balance policy
 // settings. In other words, Load Balance policy settings are on per-device basis.
 //
+//
+// Round robin position of one (or more) processors in the active path set.
+// Padded to a cache line so that processors don't write to a shared line.
+//
+typedef struct _DSM_PATH_CURSOR {
+
+    volatile ULONG Next;
+
+    UCHAR Reserved[SYSTEM_CACHE_ALIGNMENT_SIZE - sizeof(ULONG)];
+
+} DSM_PATH_CURSOR, *PDSM_PATH_CURSOR;
+
+//
+// Snapshot of the usable Active/Optimized paths of a group, used by the round
+// robin policies to pick a path without walking the DSM Ids or updating
+// PathToBeUsed on every request.
+//
+// Readers don't take a lock. Sequence is odd while the set is being rebuilt, and
+// a reader discards whatever it read if Sequence changed under it. The set is
+// rebuilt lazily by the first request that finds it Stale; the routines that
+// change path states mark it as such.
+//
+typedef struct _DSM_ACTIVE_PATH_SET {
+
+    volatile LONG Sequence;
+
+    volatile LONG Stale;
+
+    ULONG NumberPaths;
+
+    PDSM_DEVICE_INFO Paths[DSM_MAX_PATHS];
+
+    DSM_PATH_CURSOR Cursor[DSM_ACTIVE_PATH_SET_CURSORS];
+
+} DSM_ACTIVE_PATH_SET, *PDSM_ACTIVE_PATH_SET;
+
 typedef struct _DSM_GROUP_ENTRY {
 
     //
@@ -904,6 +1007,12 @@ typedef struct _DSM_GROUP_ENTRY {
     //
     BOOLEAN UseCacheForLeastBlocks;    
 
+    //
+    // Flag to indicate whether or not to keep sequential runs on one path
+    // when employing the Round Robin load balance policies.
+    //
+    BOOLEAN UseStreamAffinity;
+
     //
     // Flag used to indicate if a throttle request succeeded.
     //
@@ -941,12 +1050,31 @@ typedef struct _DSM_GROUP_ENTRY {
     //
     PVOID PathToBeUsed;
 
+    //
+    // Lock-free snapshot of the A/O paths used by the Round Robin policies
+    //
+    DSM_ACTIVE_PATH_SET ActivePathSet;
+
     //
     // Size of cache set by Admin. Used in case of handling sequential
     // IO in Least Blocks policy.
     //
     ULONGLONG CacheSizeForLeastBlocks;
 
+    //
+    // Bytes of a sequential run kept on one path by the Round Robin
+    // policies, and the run currently being tracked. Updated without a
+    // lock; a torn update only causes a run to be missed or cut short.
+    //
+    ULONG StreamAffinityThreshold;
+    DSM_STREAM Stream;
+
+    //
+    // Counters for the requests completed under each load balance policy,
+    // indexed by policy - 1.
+    //
+    DSM_LB_STATS LBStats[DSM_NUMBER_OF_LB_POLICIES];
+
     //
     // The HardwareId (VID/PID) of the LUN
     //
@@ -1025,6 +1153,13 @@ typedef struct _DSM_FAILOVER_GROUP {
     //
     volatile LONG NumberOfRequestsInFlight;
 
+    //
+    // Moving average of read/write completion latency on this path, in
+    // microseconds. 0 until the first request completes. This will be used
+    // in LST load balance policy.
+    //
+    volatile LONG AverageServiceTime;
+
     //
     // Number of devices in this FOG.
     //
@@ -500,6 +500,57 @@ DsmpDecrementCounters(
     _In_ PSCSI_REQUEST_BLOCK Srb
     );
 
+ULONG_PTR
+DsmpGetServiceTimeStamp(
+    VOID
+    );
+
+ULONG
+DsmpUpdateServiceTime(
+    _In_ PDSM_FAILOVER_GROUP FailGroup,
+    _In_ PSCSI_REQUEST_BLOCK Srb,
+    _In_ ULONG_PTR StartTime
+    );
+
+VOID
+DsmpInvalidateActivePathSet(
+    _In_ PDSM_GROUP_ENTRY Group
+    );
+
+PDSM_FAILOVER_GROUP
+DsmpGetPathFromActivePathSet(
+    _In_ PDSM_GROUP_ENTRY Group,
+    _In_ PDSM_IDS DsmList
+    );
+
+VOID
+DsmpUpdateLBPolicyStats(
+    _In_ PDSM_GROUP_ENTRY Group,
+    _In_ PSCSI_REQUEST_BLOCK Srb,
+    _In_ ULONG ServiceTime
+    );
+
+BOOLEAN
+DsmpGetRequestLbaRange(
+    _In_ PSCSI_REQUEST_BLOCK Srb,
+    _Out_ PULONGLONG StartLba,
+    _Out_ PULONG NumberBlocks
+    );
+
+PDSM_FAILOVER_GROUP
+DsmpGetStreamAffinityPath(
+    _In_ PDSM_GROUP_ENTRY Group,
+    _In_ PDSM_IDS DsmList,
+    _In_ PSCSI_REQUEST_BLOCK Srb
+    );
+
+VOID
+DsmpStartStream(
+    _In_ PDSM_GROUP_ENTRY Group,
+    _In_ PDSM_FAILOVER_GROUP FailGroup,
+    _In_ PSCSI_REQUEST_BLOCK Srb
+    );
+
 PDSM_FAILOVER_GROUP
 DsmpGetPath(
     _In_ IN PDSM_CONTEXT DsmContext,
@@ -1111,6 +1162,13 @@ DsmpQueryCacheInformationFromRegistry(
     _Out_ OUT PULONGLONG CacheSizeForLeastBlocks
     );
 
+NTSTATUS
+DsmpQueryStreamAffinityFromRegistry(
+    _In_ IN PDSM_CONTEXT DsmContext,
+    _Out_ OUT PBOOLEAN UseStreamAffinity,
+    _Out_ OUT PULONG StreamAffinityThreshold
+    );
+
 BOOLEAN
 DsmpConvertSharedSpinLockToExclusive(
     _Inout_ _Requires_lock_held_(*_Curr_) PEX_SPIN_LOCK SpinLock
@@ -1264,6 +1322,15 @@ DsmpQueryDevicePerf(
     _Out_writes_to_(*OutBufferSize, *OutBufferSize) PUCHAR Buffer
     );
 
+NTSTATUS
+DsmpQueryDeviceLBPerf(
+    _In_ PDSM_CONTEXT DsmContext,
+    _In_ PDSM_IDS DsmIds,
+    _In_ ULONG InBufferSize,
+    _Inout_ PULONG OutBufferSize,
+    _Out_writes_to_(*OutBufferSize, *OutBufferSize) PUCHAR Buffer
+    );
+
 NTSTATUS
 DsmpClearPerfCounters(
     _In_ IN PDSM_CONTEXT DsmContext,
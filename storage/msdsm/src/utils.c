@@ -6212,6 +6212,8 @@ Return Value:
                 Group,
                 PreferredActiveDeviceInfo));
 
+    DsmpInvalidateActivePathSet(Group);
+
     //
     // Ensure that:
     // 1. All devices match their ALUA state.
@@ -6670,7 +6672,7 @@ Return Value:
                         default: {
 
                             //
-                            // For RR, LQD and WP, paths must be in the same
+                            // For RR, LQD, LST and WP, paths must be in the same
                             // state as their corresponding TPG. Preferably
                             // all should be A/O.
                             //
@@ -7882,6 +7884,108 @@ Return Value:
     return status;
 }
 
+
+NTSTATUS
+DsmpQueryStreamAffinityFromRegistry(
+    _In_ IN PDSM_CONTEXT DsmContext,
+    _Out_ OUT PBOOLEAN UseStreamAffinity,
+    _Out_ OUT PULONG StreamAffinityThreshold
+    )
+/*++
+
+Routine Description:
+
+    This routine is used to get the information about whether sequential IO
+    should stay on the same path when employing the Round Robin policies, and
+    the amount of sequential data after which the run is striped again.
+    The value is determined by querying the value found at
+    "msdsm\Parameters\DsmUseStreamAffinityForRoundRobin" and
+    "msdsm\Parameters\DsmStreamAffinityThreshold"
+
+Arguments:
+
+    Context - The DSM Context value.
+    UseStreamAffinity - Returns the flag that indicates whether or not to use
+                        the same path for sequential IO when LB policy is
+                        Round Robin or Round Robin with Subset.
+    StreamAffinityThreshold - Returns the number of bytes of a sequential run
+                              that should use the same path.
+
+Return Value:
+
+    Status of the RtlQueryRegistryValues call.
+
+--*/
+{
+    RTL_QUERY_REGISTRY_TABLE queryTable[3] = {0};
+    WCHAR registryKeyName[56] = {0};
+    ULONG useStreamAffinity = 0;
+    ULONG useStreamAffinityDefault = 0;
+    ULONG streamAffinityThreshold = DSM_STREAM_AFFINITY_DEFAULT_THRESHOLD;
+    ULONG streamAffinityThresholdDefault = DSM_STREAM_AFFINITY_DEFAULT_THRESHOLD;
+    NTSTATUS status;
+
+    TracePrint((TRACE_LEVEL_VERBOSE,
+                TRACE_FLAG_PNP,
+                "DsmpQueryStreamAffinityFromRegistry (DsmCtxt %p): Entering function.\n",
+                DsmContext));
+
+    NT_ASSERT(UseStreamAffinity);
+    NT_ASSERT(StreamAffinityThreshold);
+
+    *UseStreamAffinity = FALSE;
+    *StreamAffinityThreshold = DSM_STREAM_AFFINITY_DEFAULT_THRESHOLD;
+
+    //
+    // Build the key value name that we want as the base of the query.
+    //
+    RtlStringCbPrintfW(registryKeyName,
+                       sizeof(registryKeyName),
+                       DSM_PARAMETER_PATH_W);
+
+    //
+    // The query table has three entries. One for whether to use stream affinity,
+    // one for the threshold and the third which is the 'NULL' terminator.
+    //
+    queryTable[0].Flags = RTL_QUERY_REGISTRY_DIRECT;
+    queryTable[0].Name = DSM_USE_STREAM_AFFINITY_FOR_ROUND_ROBIN;
+    queryTable[0].EntryContext = &useStreamAffinity;
+    queryTable[0].DefaultType = REG_DWORD;
+    queryTable[0].DefaultLength = sizeof(ULONG);
+    queryTable[0].DefaultData = &useStreamAffinityDefault;
+
+    queryTable[1].Flags = RTL_QUERY_REGISTRY_DIRECT;
+    queryTable[1].Name = DSM_STREAM_AFFINITY_THRESHOLD;
+    queryTable[1].EntryContext = &streamAffinityThreshold;
+    queryTable[1].DefaultType = REG_DWORD;
+    queryTable[1].DefaultLength = sizeof(ULONG);
+    queryTable[1].DefaultData = &streamAffinityThresholdDefault;
+
+    status = RtlQueryRegistryValues(RTL_REGISTRY_SERVICES,
+                                    registryKeyName,
+                                    queryTable,
+                                    registryKeyName,
+                                    NULL);
+
+    if (NT_SUCCESS(status)) {
+
+        *UseStreamAffinity = (useStreamAffinity != 0);
+
+        if (streamAffinityThreshold != 0) {
+
+            *StreamAffinityThreshold = streamAffinityThreshold;
+        }
+    }
+
+    TracePrint((TRACE_LEVEL_VERBOSE,
+                TRACE_FLAG_PNP,
+                "DsmpQueryStreamAffinityFromRegistry (DsmCtxt %p): Exiting function with status %x.\n",
+                DsmContext,
+                status));
+
+    return status;
+}
+
 BOOLEAN
 DsmpConvertSharedSpinLockToExclusive(
     _Inout_ _Requires_lock_held_(*_Curr_) PEX_SPIN_LOCK SpinLock
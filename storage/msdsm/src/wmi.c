@@ -96,6 +96,7 @@ GUID DSM_QueryLBPolicyV2GUID = DSM_QueryLBPolicy_V2Guid;
 GUID DSM_QuerySupportedLBPoliciesV2GUID = DSM_QuerySupportedLBPolicies_V2Guid;
 GUID MSDSM_DEVICE_PERFGUID = MSDSM_DEVICE_PERFGuid;
 GUID MSDSM_WMI_METHODSGUID = MSDSM_WMI_METHODSGuid;
+GUID MSDSM_DEVICE_LB_PERFGUID = MSDSM_DEVICE_LB_PERFGuid;
 
 //
 // Symbolic names for the Device-centric guid indexes
@@ -108,6 +109,7 @@ GUID MSDSM_WMI_METHODSGUID = MSDSM_WMI_METHODSGuid;
 #define DSM_QuerySupportedLBPoliciesV2GUID_Index    5
 #define MSDSM_DEVICE_PERFGuidIndex                  6
 #define MSDSM_WMI_METHODSGuidIndex                  7
+#define MSDSM_DEVICE_LB_PERFGuidIndex               8
 
 WMIGUIDREGINFO DsmGuidList[] = {
     {
@@ -156,6 +158,12 @@ WMIGUIDREGINFO DsmGuidList[] = {
         &MSDSM_WMI_METHODSGUID,
         1,
         0
+    },
+
+    {
+        &MSDSM_DEVICE_LB_PERFGUID,
+        1,
+        0
     }
 };
 
@@ -495,7 +503,7 @@ Return Value:
                     continue;
                 }
 
-                if (targetPolicyInfo->LoadBalancePolicy >= DSM_LB_VENDOR_SPECIFIC) {
+                if (targetPolicyInfo->LoadBalancePolicy > DSM_LB_LEAST_SERVICE_TIME) {
 
                     errorStatus = STATUS_INVALID_PARAMETER;
 
@@ -571,7 +579,7 @@ Return Value:
             //
             // First ensure that the values make sense.
             //
-            if (loadBalancePolicy >= DSM_LB_VENDOR_SPECIFIC) {
+            if (loadBalancePolicy > DSM_LB_LEAST_SERVICE_TIME) {
 
                 status = STATUS_INVALID_PARAMETER;
                 TracePrint((TRACE_LEVEL_ERROR,
@@ -870,6 +878,19 @@ Return Value:
             break;
         }
 
+        case MSDSM_DEVICE_LB_PERFGuidIndex: {
+
+            *DataLength = BufferAvail;
+
+            status = DsmpQueryDeviceLBPerf(DsmContext,
+                                           DsmIds,
+                                           BufferAvail,
+                                           DataLength,
+                                           Buffer);
+
+            break;
+        }
+
         case MSDSM_WMI_METHODSGuidIndex: {
 
             //
@@ -1175,7 +1196,8 @@ Return Value:
             NT_ASSERT(groupEntry->LoadBalanceType != DSM_LB_ROUND_ROBIN &&
                    groupEntry->LoadBalanceType != DSM_LB_WEIGHTED_PATHS &&
                    groupEntry->LoadBalanceType != DSM_LB_DYN_LEAST_QUEUE_DEPTH &&
-                   groupEntry->LoadBalanceType != DSM_LB_LEAST_BLOCKS);
+                   groupEntry->LoadBalanceType != DSM_LB_LEAST_BLOCKS &&
+                   groupEntry->LoadBalanceType != DSM_LB_LEAST_SERVICE_TIME);
         }
 #endif
 
@@ -2575,7 +2597,7 @@ Return Value:
     }
 
     if ((supportedLBPolicies->LoadBalancePolicy < DSM_LB_FAILOVER) ||
-        (supportedLBPolicies->LoadBalancePolicy > DSM_LB_LEAST_BLOCKS)) {
+        (supportedLBPolicies->LoadBalancePolicy > DSM_LB_LEAST_SERVICE_TIME)) {
 
         TracePrint((TRACE_LEVEL_ERROR,
                     TRACE_FLAG_WMI,
@@ -3140,6 +3162,134 @@ __Exit_DsmpQueryDevicePerf:
 }
 
 
+NTSTATUS
+DsmpQueryDeviceLBPerf(
+    _In_ PDSM_CONTEXT DsmContext,
+    _In_ PDSM_IDS DsmIds,
+    _In_ ULONG InBufferSize,
+    _Inout_ PULONG OutBufferSize,
+    _Out_writes_to_(*OutBufferSize, *OutBufferSize) PUCHAR Buffer
+    )
+/*++
+
+Routine Description:
+
+    This routine returns the throughput counters accumulated under each
+    load balance policy for the device that corresponds to the passed in DsmIds.
+
+Arguements:
+
+    DsmContext - Global DSM context
+    DsmIds - DSM Ids for the given device
+    InBufferSize - Size of the input buffer
+    OutBufferSize - Size of the output buffer
+    Buffer - Buffer in which the per policy counters are returned, if the
+             buffer is big enough
+
+Return Value:
+
+   STATUS_SUCCESS on success
+   Appropriate error code on error.
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PDSM_DEVICE_INFO devInfo;
+    PDSM_GROUP_ENTRY group;
+    ULONG sizeNeeded;
+    PMSDSM_DEVICE_LB_PERF deviceLBPerf;
+    ULONG i;
+    PMSDSM_LB_POLICY_PERF policyPerf;
+    KIRQL irql;
+
+    UNREFERENCED_PARAMETER(InBufferSize);
+
+    TracePrint((TRACE_LEVEL_VERBOSE,
+                TRACE_FLAG_WMI,
+                "DsmpQueryDeviceLBPerf (DsmIds %p): Entering function.\n",
+                DsmIds));
+
+    //
+    // At least one device should be given
+    //
+    if (DsmIds->Count == 0) {
+
+        TracePrint((TRACE_LEVEL_ERROR,
+                    TRACE_FLAG_WMI,
+                    "DsmpQueryDeviceLBPerf (DsmIds %p): No DSM Ids given.\n",
+                    DsmIds));
+
+        *OutBufferSize = 0;
+        status = STATUS_INVALID_PARAMETER;
+
+        goto __Exit_DsmpQueryDeviceLBPerf;
+    }
+
+    sizeNeeded = AlignOn8Bytes(FIELD_OFFSET(MSDSM_DEVICE_LB_PERF, PolicyPerf));
+    sizeNeeded += (DSM_NUMBER_OF_LB_POLICIES * sizeof(MSDSM_LB_POLICY_PERF));
+
+    if (*OutBufferSize < sizeNeeded) {
+
+        TracePrint((TRACE_LEVEL_ERROR,
+                    TRACE_FLAG_WMI,
+                    "DsmpQueryDeviceLBPerf (DsmIds %p): Output buffer too small for QueryDeviceLBPerf.\n",
+                    DsmIds));
+
+        *OutBufferSize = sizeNeeded;
+        status = STATUS_BUFFER_TOO_SMALL;
+
+        goto __Exit_DsmpQueryDeviceLBPerf;
+    }
+
+    //
+    // Zero out the output buffer first
+    //
+    RtlZeroMemory(Buffer, sizeNeeded);
+
+    devInfo = DsmIds->IdList[0];
+    DSM_ASSERT(devInfo);
+    DSM_ASSERT(devInfo->DeviceSig == DSM_DEVICE_SIG);
+
+    irql = ExAcquireSpinLockExclusive(&(DsmContext->DsmContextLock));
+
+    group = devInfo->Group;
+
+    deviceLBPerf = (PMSDSM_DEVICE_LB_PERF)Buffer;
+    deviceLBPerf->NumberPolicies = DSM_NUMBER_OF_LB_POLICIES;
+
+    //
+    // For each policy, get the stats info
+    //
+    for (i = 0; i < DSM_NUMBER_OF_LB_POLICIES; i++) {
+
+        policyPerf = &deviceLBPerf->PolicyPerf[i];
+        policyPerf->LoadBalancePolicy = i + 1;
+
+        if (group) {
+
+            policyPerf->NumberRequests = group->LBStats[i].NumberRequests;
+            policyPerf->BytesTransferred = group->LBStats[i].BytesTransferred;
+            policyPerf->TotalServiceTime = group->LBStats[i].TotalServiceTime;
+            policyPerf->StreamAffinityRequests = group->LBStats[i].StreamAffinityRequests;
+        }
+    }
+
+    ExReleaseSpinLockExclusive(&(DsmContext->DsmContextLock), irql);
+
+    *OutBufferSize = sizeNeeded;
+
+__Exit_DsmpQueryDeviceLBPerf:
+
+    TracePrint((TRACE_LEVEL_VERBOSE,
+                TRACE_FLAG_WMI,
+                "DsmpQueryDeviceLBPerf (DsmIds %p): Exiting function with status %x.\n",
+                DsmIds,
+                status));
+
+    return status;
+}
+
+
 NTSTATUS
 DsmpClearPerfCounters(
     _In_ IN PDSM_CONTEXT DsmContext,
@@ -3202,6 +3352,10 @@ Return Value:
             (devInfo->DeviceStats).BytesWritten = 0;
             (devInfo->DeviceStats).NumberReads = 0;
             (devInfo->DeviceStats).NumberWrites = 0;
+
+            if (devInfo->Group) {
+                RtlZeroMemory(devInfo->Group->LBStats, sizeof(devInfo->Group->LBStats));
+            }
         }
     }
 
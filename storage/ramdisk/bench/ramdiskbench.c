@@ -0,0 +1,991 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+Module Name:
+
+    ramdiskbench.c
+
+Abstract:
+
+    This file contains a user mode random 4K IOPS benchmark for the RAM
+    disk sample.  For each memory layout of the disk image it sets the
+    layout parameters under the Ramdisk service key, restarts the RAM disk
+    device so that the driver allocates the image again, and then runs
+    random 4K reads and writes against the raw volume from a number of
+    threads.  It writes one CSV line per layout with the operation rate
+    and latency percentiles, and puts the original parameters back when
+    it is done.
+
+    The layouts are
+
+        default     - 64 KB pool chunks
+        largepage   - 2 MB large-page aligned chunks (LargePages)
+        numa        - chunks pinned to one NUMA node (NumaNode)
+        interleave  - chunks spread over all NUMA nodes (NumaInterleave)
+
+    The benchmark has to run as Administrator.  The volume is dismounted
+    for the run, and the driver formats a new image for every layout, so
+    anything stored on the RAM disk is lost.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_code_)
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <windows.h>
+#include <winioctl.h>
+#include <setupapi.h>
+#include <strsafe.h>
+
+#define SUCCESS              0
+#define USAGE_ERROR          1
+#define WORKLOAD_ERROR       2
+
+#define BENCH_IO_SIZE        4096
+#define DEFAULT_SECONDS      10
+#define DEFAULT_WRITE_PERCENT 0
+#define DEFAULT_NODE         0
+#define DEFAULT_DRIVE        L"R:"
+
+#define MAX_THREADS          64
+#define SAMPLES_PER_THREAD   (256 * 1024)
+
+//
+//  Seconds to wait for the volume to come back after a restart.
+//
+
+#define RESTART_TIMEOUT      30
+
+#define RAMDISK_HARDWARE_ID  L"Ramdisk"
+#define RAMDISK_PARAMETERS   L"SYSTEM\\CurrentControlSet\\Services\\Ramdisk\\Parameters"
+
+//
+//  Driver defaults, from ramdisk.h.
+//
+
+#define NO_NUMA_NODE         0x80000000
+
+//
+//  A memory layout of the disk image, as the three registry values which
+//  select it.  A NumaNode of (ULONG)-1 means the node from the command
+//  line.
+//
+
+typedef struct _BENCH_LAYOUT {
+
+    PCWSTR Name;
+    ULONG LargePages;
+    ULONG NumaNode;
+    ULONG NumaInterleave;
+
+} BENCH_LAYOUT;
+
+const BENCH_LAYOUT Layouts[] = {
+    { L"default",    0, NO_NUMA_NODE, 0 },
+    { L"largepage",  1, NO_NUMA_NODE, 0 },
+    { L"numa",       0, (ULONG)-1,    0 },
+    { L"interleave", 0, NO_NUMA_NODE, 1 },
+};
+
+#define LAYOUT_COUNT  (sizeof( Layouts ) / sizeof( Layouts[0] ))
+
+PCWSTR LayoutValueNames[] = { L"LargePages", L"NumaNode", L"NumaInterleave" };
+
+#define LAYOUT_VALUE_COUNT  (sizeof( LayoutValueNames ) / sizeof( LayoutValueNames[0] ))
+
+//
+//  Settings for a run, taken from the command line.
+//
+
+typedef struct _BENCH_CONTEXT {
+
+    WCHAR Drive[8];
+
+    ULONG Threads;
+    ULONG Seconds;
+    ULONG WritePercent;
+    ULONG Node;
+
+    //
+    //  The volume, opened for overlapped non-cached Io so the threads do
+    //  not serialize on the file object.
+    //
+
+    HANDLE Volume;
+    ULONGLONG Blocks;
+
+    LARGE_INTEGER Frequency;
+
+    volatile LONG Stop;
+
+} BENCH_CONTEXT, *PBENCH_CONTEXT;
+
+//
+//  State for one Io thread.
+//
+
+typedef struct _BENCH_THREAD {
+
+    PBENCH_CONTEXT Context;
+    ULONG Index;
+
+    PVOID IoBuffer;
+
+    //
+    //  Latency samples, in performance counter ticks.  Samples past the
+    //  space we allocated are counted but not kept.
+    //
+
+    PULONGLONG Samples;
+    ULONG SampleCount;
+    ULONGLONG Operations;
+
+    DWORD Status;
+
+} BENCH_THREAD, *PBENCH_THREAD;
+
+
+VOID
+Usage (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    Prints usage
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+
+{
+    wprintf( L"Usage: ramdiskbench [-d drive] [-t threads] [-s seconds] [-w writepercent] [-n node] [layout ...]\n"
+             L"    -d        - drive letter of the RAM disk (default %s)\n"
+             L"    -t        - number of Io threads, one Io outstanding each (default one per processor)\n"
+             L"    -s        - seconds to run each layout (default %u)\n"
+             L"    -w        - percentage of the Ios which are writes (default %u)\n"
+             L"    -n        - NUMA node for the numa layout (default %u)\n"
+             L"    layout    - any of default largepage numa interleave\n"
+             L"                (default all, in that order)\n",
+             DEFAULT_DRIVE,
+             DEFAULT_SECONDS,
+             DEFAULT_WRITE_PERCENT,
+             DEFAULT_NODE );
+}
+
+
+int
+__cdecl
+CompareSamples (
+    _In_ const void *First,
+    _In_ const void *Second
+    )
+{
+    ULONGLONG A = *(const ULONGLONG *)First;
+    ULONGLONG B = *(const ULONGLONG *)Second;
+
+    return (A < B) ? -1 : ((A > B) ? 1 : 0);
+}
+
+
+ULONGLONG
+Percentile (
+    _In_reads_(Count) PULONGLONG Samples,
+    _In_ ULONG Count,
+    _In_ ULONG Percent,
+    _In_ PLARGE_INTEGER Frequency
+    )
+
+/*++
+
+Routine Description:
+
+    Returns the given percentile of the sorted samples in microseconds.
+
+--*/
+
+{
+    ULONG Index;
+
+    if (Count == 0) {
+
+        return 0;
+    }
+
+    Index = (ULONG)(((ULONGLONG)(Count - 1) * Percent) / 100);
+
+    return (Samples[Index] * 1000000) / Frequency->QuadPart;
+}
+
+
+ULONG
+NextRandom (
+    _Inout_ PULONGLONG State
+    )
+
+/*++
+
+Routine Description:
+
+    A per-thread xorshift generator.  rand() takes a lock in the CRT, which
+    would show up in the numbers at the rates a RAM disk runs at.
+
+--*/
+
+{
+    ULONGLONG X = *State;
+
+    X ^= X << 13;
+    X ^= X >> 7;
+    X ^= X << 17;
+
+    *State = X;
+
+    return (ULONG)(X >> 32);
+}
+
+
+DWORD
+WINAPI
+IoThread (
+    _In_ PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    Issues random 4K reads and writes to the volume, one at a time, until
+    the run is stopped.
+
+Arguments:
+
+    Parameter - The BENCH_THREAD for this thread.
+
+Return Value:
+
+    Win32 error code.
+
+--*/
+
+{
+    PBENCH_THREAD Thread = Parameter;
+    PBENCH_CONTEXT Context = Thread->Context;
+    ULONGLONG Random = 0x9E3779B97F4A7C15ULL * (Thread->Index + 1);
+    LARGE_INTEGER Start;
+    LARGE_INTEGER End;
+    OVERLAPPED Overlapped;
+    ULONGLONG Offset;
+    DWORD Transferred;
+    BOOL Result;
+
+    ZeroMemory( &Overlapped, sizeof( Overlapped ));
+
+    Overlapped.hEvent = CreateEventW( NULL, TRUE, FALSE, NULL );
+
+    if (Overlapped.hEvent == NULL) {
+
+        Thread->Status = GetLastError();
+        return Thread->Status;
+    }
+
+    while (!Context->Stop) {
+
+        Offset = ((((ULONGLONG)NextRandom( &Random ) << 32) | NextRandom( &Random )) % Context->Blocks) * BENCH_IO_SIZE;
+
+        Overlapped.Offset = (DWORD)Offset;
+        Overlapped.OffsetHigh = (DWORD)(Offset >> 32);
+
+        QueryPerformanceCounter( &Start );
+
+        if ((NextRandom( &Random ) % 100) < Context->WritePercent) {
+
+            Result = WriteFile( Context->Volume, Thread->IoBuffer, BENCH_IO_SIZE, NULL, &Overlapped );
+
+        } else {
+
+            Result = ReadFile( Context->Volume, Thread->IoBuffer, BENCH_IO_SIZE, NULL, &Overlapped );
+        }
+
+        if (!Result && (GetLastError() != ERROR_IO_PENDING)) {
+
+            Thread->Status = GetLastError();
+            break;
+        }
+
+        if (!GetOverlappedResult( Context->Volume, &Overlapped, &Transferred, TRUE )) {
+
+            Thread->Status = GetLastError();
+            break;
+        }
+
+        QueryPerformanceCounter( &End );
+
+        if (Thread->SampleCount < SAMPLES_PER_THREAD) {
+
+            Thread->Samples[Thread->SampleCount++] = (ULONGLONG)(End.QuadPart - Start.QuadPart);
+        }
+
+        Thread->Operations += 1;
+    }
+
+    CloseHandle( Overlapped.hEvent );
+
+    return Thread->Status;
+}
+
+
+DWORD
+SetLayout (
+    _In_ PBENCH_CONTEXT Context,
+    _In_ const BENCH_LAYOUT *Layout
+    )
+
+/*++
+
+Routine Description:
+
+    Writes the registry values which select the given layout.
+
+--*/
+
+{
+    ULONG Values[LAYOUT_VALUE_COUNT];
+    HKEY Key;
+    DWORD Status;
+    ULONG Index;
+
+    Values[0] = Layout->LargePages;
+    Values[1] = (Layout->NumaNode == (ULONG)-1) ? Context->Node : Layout->NumaNode;
+    Values[2] = Layout->NumaInterleave;
+
+    Status = RegOpenKeyExW( HKEY_LOCAL_MACHINE, RAMDISK_PARAMETERS, 0, KEY_SET_VALUE, &Key );
+
+    if (Status != ERROR_SUCCESS) {
+
+        return Status;
+    }
+
+    for (Index = 0; Index < LAYOUT_VALUE_COUNT; Index += 1) {
+
+        Status = RegSetValueExW( Key,
+                                 LayoutValueNames[Index],
+                                 0,
+                                 REG_DWORD,
+                                 (const BYTE *)&Values[Index],
+                                 sizeof( ULONG ));
+
+        if (Status != ERROR_SUCCESS) {
+
+            break;
+        }
+    }
+
+    RegCloseKey( Key );
+
+    return Status;
+}
+
+
+VOID
+SaveLayout (
+    _Out_writes_(LAYOUT_VALUE_COUNT) PULONG Values,
+    _Out_writes_(LAYOUT_VALUE_COUNT) PBOOLEAN Present
+    )
+
+/*++
+
+Routine Description:
+
+    Reads the layout values as they were before the run, so they can be
+    put back afterwards.
+
+--*/
+
+{
+    ULONG Index;
+    DWORD Size;
+
+    for (Index = 0; Index < LAYOUT_VALUE_COUNT; Index += 1) {
+
+        Size = sizeof( ULONG );
+
+        Present[Index] = (RegGetValueW( HKEY_LOCAL_MACHINE,
+                                        RAMDISK_PARAMETERS,
+                                        LayoutValueNames[Index],
+                                        RRF_RT_REG_DWORD,
+                                        NULL,
+                                        &Values[Index],
+                                        &Size ) == ERROR_SUCCESS);
+    }
+}
+
+
+VOID
+RestoreLayout (
+    _In_reads_(LAYOUT_VALUE_COUNT) PULONG Values,
+    _In_reads_(LAYOUT_VALUE_COUNT) PBOOLEAN Present
+    )
+{
+    HKEY Key;
+    ULONG Index;
+
+    if (RegOpenKeyExW( HKEY_LOCAL_MACHINE, RAMDISK_PARAMETERS, 0, KEY_SET_VALUE, &Key ) != ERROR_SUCCESS) {
+
+        return;
+    }
+
+    for (Index = 0; Index < LAYOUT_VALUE_COUNT; Index += 1) {
+
+        if (Present[Index]) {
+
+            RegSetValueExW( Key, LayoutValueNames[Index], 0, REG_DWORD, (const BYTE *)&Values[Index], sizeof( ULONG ));
+
+        } else {
+
+            RegDeleteValueW( Key, LayoutValueNames[Index] );
+        }
+    }
+
+    RegCloseKey( Key );
+}
+
+
+DWORD
+RestartRamdisk (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    Restarts the RAM disk device, the way "devcon restart Ramdisk" does.
+    The driver reads its parameters and allocates the disk image when the
+    device is added, so this is what makes a new layout take effect.
+
+Return Value:
+
+    Win32 error code.
+
+--*/
+
+{
+    SP_DEVINFO_DATA DeviceInfo;
+    SP_PROPCHANGE_PARAMS PropChange;
+    WCHAR HardwareIds[256];
+    HDEVINFO DeviceSet;
+    DWORD Status = ERROR_FILE_NOT_FOUND;
+    DWORD Index;
+    PCWSTR Id;
+
+    DeviceSet = SetupDiGetClassDevsW( NULL, L"ROOT", NULL, DIGCF_ALLCLASSES | DIGCF_PRESENT );
+
+    if (DeviceSet == INVALID_HANDLE_VALUE) {
+
+        return GetLastError();
+    }
+
+    DeviceInfo.cbSize = sizeof( DeviceInfo );
+
+    for (Index = 0; SetupDiEnumDeviceInfo( DeviceSet, Index, &DeviceInfo ); Index += 1) {
+
+        ZeroMemory( HardwareIds, sizeof( HardwareIds ));
+
+        if (!SetupDiGetDeviceRegistryPropertyW( DeviceSet,
+                                                &DeviceInfo,
+                                                SPDRP_HARDWAREID,
+                                                NULL,
+                                                (PBYTE)HardwareIds,
+                                                sizeof( HardwareIds ) - sizeof( WCHAR ) * 2,
+                                                NULL )) {
+
+            continue;
+        }
+
+        for (Id = HardwareIds; *Id != UNICODE_NULL; Id += wcslen( Id ) + 1) {
+
+            if (_wcsicmp( Id, RAMDISK_HARDWARE_ID ) == 0) {
+
+                break;
+            }
+        }
+
+        if (*Id == UNICODE_NULL) {
+
+            continue;
+        }
+
+        ZeroMemory( &PropChange, sizeof( PropChange ));
+
+        PropChange.ClassInstallHeader.cbSize = sizeof( SP_CLASSINSTALL_HEADER );
+        PropChange.ClassInstallHeader.InstallFunction = DIF_PROPERTYCHANGE;
+        PropChange.StateChange = DICS_PROPCHANGE;
+        PropChange.Scope = DICS_FLAG_CONFIGSPECIFIC;
+        PropChange.HwProfile = 0;
+
+        if (!SetupDiSetClassInstallParamsW( DeviceSet,
+                                            &DeviceInfo,
+                                            &PropChange.ClassInstallHeader,
+                                            sizeof( PropChange )) ||
+            !SetupDiCallClassInstaller( DIF_PROPERTYCHANGE, DeviceSet, &DeviceInfo )) {
+
+            Status = GetLastError();
+
+        } else {
+
+            Status = ERROR_SUCCESS;
+        }
+
+        break;
+    }
+
+    SetupDiDestroyDeviceInfoList( DeviceSet );
+
+    return Status;
+}
+
+
+BOOL
+DeviceIoControlSync (
+    _In_ PBENCH_CONTEXT Context,
+    _In_ DWORD IoControlCode,
+    _Out_writes_bytes_opt_(OutputSize) PVOID Output,
+    _In_ DWORD OutputSize
+    )
+
+/*++
+
+Routine Description:
+
+    Sends a control request on the overlapped volume handle and waits for
+    it.
+
+--*/
+
+{
+    OVERLAPPED Overlapped;
+    DWORD Returned;
+    BOOL Result;
+
+    ZeroMemory( &Overlapped, sizeof( Overlapped ));
+
+    Overlapped.hEvent = CreateEventW( NULL, TRUE, FALSE, NULL );
+
+    if (Overlapped.hEvent == NULL) {
+
+        return FALSE;
+    }
+
+    Result = DeviceIoControl( Context->Volume, IoControlCode, NULL, 0, Output, OutputSize, &Returned, &Overlapped );
+
+    if (!Result && (GetLastError() == ERROR_IO_PENDING)) {
+
+        Result = GetOverlappedResult( Context->Volume, &Overlapped, &Returned, TRUE );
+    }
+
+    CloseHandle( Overlapped.hEvent );
+
+    return Result;
+}
+
+
+DWORD
+OpenVolume (
+    _Inout_ PBENCH_CONTEXT Context
+    )
+
+/*++
+
+Routine Description:
+
+    Opens the RAM disk volume for the run, waiting for it to come back
+    after a restart.  The volume is locked and dismounted so that writes
+    reach the disk and the file system doesn't see them.
+
+--*/
+
+{
+    GET_LENGTH_INFORMATION Length;
+    WCHAR Path[16];
+    DWORD Status;
+    ULONG Wait;
+
+    StringCchPrintfW( Path, RTL_NUMBER_OF( Path ), L"\\\\.\\%s", Context->Drive );
+
+    for (Wait = 0; ; Wait += 1) {
+
+        Context->Volume = CreateFileW( Path,
+                                       GENERIC_READ | GENERIC_WRITE,
+                                       FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                       NULL,
+                                       OPEN_EXISTING,
+                                       FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED,
+                                       NULL );
+
+        if (Context->Volume != INVALID_HANDLE_VALUE) {
+
+            break;
+        }
+
+        if (Wait == RESTART_TIMEOUT) {
+
+            return GetLastError();
+        }
+
+        Sleep( 1000 );
+    }
+
+    if (!DeviceIoControlSync( Context, FSCTL_LOCK_VOLUME, NULL, 0 ) ||
+        !DeviceIoControlSync( Context, FSCTL_DISMOUNT_VOLUME, NULL, 0 ) ||
+        !DeviceIoControlSync( Context, IOCTL_DISK_GET_LENGTH_INFO, &Length, sizeof( Length ))) {
+
+        Status = GetLastError();
+        CloseHandle( Context->Volume );
+        Context->Volume = INVALID_HANDLE_VALUE;
+        return Status;
+    }
+
+    Context->Blocks = (ULONGLONG)Length.Length.QuadPart / BENCH_IO_SIZE;
+
+    if (Context->Blocks == 0) {
+
+        CloseHandle( Context->Volume );
+        Context->Volume = INVALID_HANDLE_VALUE;
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    return ERROR_SUCCESS;
+}
+
+
+DWORD
+RunLayout (
+    _Inout_ PBENCH_CONTEXT Context,
+    _In_ const BENCH_LAYOUT *Layout,
+    _Inout_updates_(Context->Threads) PBENCH_THREAD Threads,
+    _Inout_updates_(Context->Threads * SAMPLES_PER_THREAD) PULONGLONG AllSamples
+    )
+
+/*++
+
+Routine Description:
+
+    Switches the RAM disk to one layout and runs the Io threads against it
+    for the configured time, then prints the results.
+
+Arguments:
+
+    Context - The benchmark context.
+
+    Layout - The layout to run.
+
+    Threads - The Io thread state, with buffers allocated.
+
+    AllSamples - Space to merge the samples of every thread for sorting.
+
+Return Value:
+
+    Win32 error code.
+
+--*/
+
+{
+    HANDLE Handles[MAX_THREADS];
+    LARGE_INTEGER Start;
+    LARGE_INTEGER End;
+    ULONGLONG Operations = 0;
+    ULONG SampleCount = 0;
+    double Seconds;
+    DWORD Status;
+    ULONG Index;
+
+    Status = SetLayout( Context, Layout );
+
+    if (Status != ERROR_SUCCESS) {
+
+        fwprintf( stderr, L"ramdiskbench: can't set the %s layout, error %u\n", Layout->Name, Status );
+        return Status;
+    }
+
+    Status = RestartRamdisk();
+
+    if (Status != ERROR_SUCCESS) {
+
+        fwprintf( stderr, L"ramdiskbench: can't restart the RAM disk, error %u\n", Status );
+        return Status;
+    }
+
+    Status = OpenVolume( Context );
+
+    if (Status != ERROR_SUCCESS) {
+
+        fwprintf( stderr, L"ramdiskbench: can't open %s, error %u\n", Context->Drive, Status );
+        return Status;
+    }
+
+    Context->Stop = FALSE;
+
+    for (Index = 0; Index < Context->Threads; Index += 1) {
+
+        Threads[Index].SampleCount = 0;
+        Threads[Index].Operations = 0;
+        Threads[Index].Status = ERROR_SUCCESS;
+    }
+
+    QueryPerformanceCounter( &Start );
+
+    for (Index = 0; Index < Context->Threads; Index += 1) {
+
+        Handles[Index] = CreateThread( NULL, 0, IoThread, &Threads[Index], 0, NULL );
+
+        if (Handles[Index] == NULL) {
+
+            Status = GetLastError();
+            break;
+        }
+    }
+
+    if (Status == ERROR_SUCCESS) {
+
+        Sleep( Context->Seconds * 1000 );
+    }
+
+    InterlockedExchange( &Context->Stop, TRUE );
+
+    WaitForMultipleObjects( Index, Handles, TRUE, INFINITE );
+
+    QueryPerformanceCounter( &End );
+
+    while (Index > 0) {
+
+        Index -= 1;
+        CloseHandle( Handles[Index] );
+    }
+
+    //
+    //  Closing the handle unlocks the volume and lets the file system mount
+    //  it again.
+    //
+
+    CloseHandle( Context->Volume );
+    Context->Volume = INVALID_HANDLE_VALUE;
+
+    if (Status != ERROR_SUCCESS) {
+
+        fwprintf( stderr, L"ramdiskbench: can't start the Io threads, error %u\n", Status );
+        return Status;
+    }
+
+    for (Index = 0; Index < Context->Threads; Index += 1) {
+
+        if (Threads[Index].Status != ERROR_SUCCESS) {
+
+            fwprintf( stderr, L"ramdiskbench: %s Io failed with error %u\n", Layout->Name, Threads[Index].Status );
+            return Threads[Index].Status;
+        }
+
+        CopyMemory( &AllSamples[SampleCount],
+                    Threads[Index].Samples,
+                    (SIZE_T)Threads[Index].SampleCount * sizeof( ULONGLONG ));
+
+        SampleCount += Threads[Index].SampleCount;
+        Operations += Threads[Index].Operations;
+    }
+
+    Seconds = (double)(End.QuadPart - Start.QuadPart) / (double)Context->Frequency.QuadPart;
+
+    qsort( AllSamples, SampleCount, sizeof( ULONGLONG ), CompareSamples );
+
+    wprintf( L"%s,%u,%u,%I64u,%.3f,%.0f,%I64u,%I64u,%I64u,%I64u\n",
+             Layout->Name,
+             Context->Threads,
+             Context->WritePercent,
+             Operations,
+             Seconds,
+             (Seconds > 0) ? (Operations / Seconds) : 0.0,
+             Percentile( AllSamples, SampleCount, 50, &Context->Frequency ),
+             Percentile( AllSamples, SampleCount, 90, &Context->Frequency ),
+             Percentile( AllSamples, SampleCount, 99, &Context->Frequency ),
+             Percentile( AllSamples, SampleCount, 100, &Context->Frequency ));
+
+    return ERROR_SUCCESS;
+}
+
+
+int
+_cdecl
+wmain (
+    _In_ int argc,
+    _In_reads_(argc) WCHAR *argv[]
+    )
+{
+    BENCH_CONTEXT Context;
+    BENCH_THREAD Threads[MAX_THREADS];
+    BOOLEAN Selected[LAYOUT_COUNT];
+    BOOLEAN AnySelected = FALSE;
+    ULONG SavedValues[LAYOUT_VALUE_COUNT];
+    BOOLEAN SavedPresent[LAYOUT_VALUE_COUNT];
+    PULONGLONG AllSamples = NULL;
+    DWORD Status = ERROR_SUCCESS;
+    SYSTEM_INFO SystemInfo;
+    int ArgIndex;
+    ULONG Index;
+
+    ZeroMemory( &Context, sizeof( Context ));
+    ZeroMemory( Threads, sizeof( Threads ));
+    ZeroMemory( Selected, sizeof( Selected ));
+
+    GetSystemInfo( &SystemInfo );
+
+    StringCchCopyW( Context.Drive, RTL_NUMBER_OF( Context.Drive ), DEFAULT_DRIVE );
+    Context.Threads = min( SystemInfo.dwNumberOfProcessors, MAX_THREADS );
+    Context.Seconds = DEFAULT_SECONDS;
+    Context.WritePercent = DEFAULT_WRITE_PERCENT;
+    Context.Node = DEFAULT_NODE;
+    Context.Volume = INVALID_HANDLE_VALUE;
+
+    for (ArgIndex = 1; ArgIndex < argc; ArgIndex += 1) {
+
+        if ((argv[ArgIndex][0] == L'-') && (ArgIndex + 1 < argc)) {
+
+            ULONG Value = wcstoul( argv[ArgIndex + 1], NULL, 0 );
+
+            switch (argv[ArgIndex][1]) {
+
+            case L'd':
+                if (FAILED( StringCchCopyW( Context.Drive, RTL_NUMBER_OF( Context.Drive ), argv[ArgIndex + 1] ))) {
+
+                    Usage();
+                    return USAGE_ERROR;
+                }
+                break;
+
+            case L't': Context.Threads = Value; break;
+            case L's': Context.Seconds = Value; break;
+            case L'w': Context.WritePercent = Value; break;
+            case L'n': Context.Node = Value; break;
+
+            default:
+                Usage();
+                return USAGE_ERROR;
+            }
+
+            ArgIndex += 1;
+            continue;
+        }
+
+        for (Index = 0; Index < LAYOUT_COUNT; Index += 1) {
+
+            if (_wcsicmp( argv[ArgIndex], Layouts[Index].Name ) == 0) {
+
+                Selected[Index] = TRUE;
+                AnySelected = TRUE;
+                break;
+            }
+        }
+
+        if (Index == LAYOUT_COUNT) {
+
+            Usage();
+            return USAGE_ERROR;
+        }
+    }
+
+    if ((Context.Threads == 0) || (Context.Threads > MAX_THREADS) ||
+        (Context.Seconds == 0) || (Context.WritePercent > 100)) {
+
+        Usage();
+        return USAGE_ERROR;
+    }
+
+    QueryPerformanceFrequency( &Context.Frequency );
+
+    AllSamples = malloc( (SIZE_T)Context.Threads * SAMPLES_PER_THREAD * sizeof( ULONGLONG ));
+
+    if (AllSamples == NULL) {
+
+        fwprintf( stderr, L"ramdiskbench: out of memory\n" );
+        return WORKLOAD_ERROR;
+    }
+
+    for (Index = 0; Index < Context.Threads; Index += 1) {
+
+        Threads[Index].Context = &Context;
+        Threads[Index].Index = Index;
+
+        //
+        //  VirtualAlloc gives us the page alignment non-cached Io requires.
+        //
+
+        Threads[Index].IoBuffer = VirtualAlloc( NULL, BENCH_IO_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE );
+        Threads[Index].Samples = malloc( SAMPLES_PER_THREAD * sizeof( ULONGLONG ));
+
+        if ((Threads[Index].IoBuffer == NULL) || (Threads[Index].Samples == NULL)) {
+
+            fwprintf( stderr, L"ramdiskbench: out of memory\n" );
+            Status = ERROR_NOT_ENOUGH_MEMORY;
+            goto Cleanup;
+        }
+
+        FillMemory( Threads[Index].IoBuffer, BENCH_IO_SIZE, 0xA5 );
+    }
+
+    SaveLayout( SavedValues, SavedPresent );
+
+    wprintf( L"layout,threads,write_pct,ops,seconds,iops,p50_us,p90_us,p99_us,max_us\n" );
+
+    for (Index = 0; Index < LAYOUT_COUNT; Index += 1) {
+
+        if (AnySelected && !Selected[Index]) {
+
+            continue;
+        }
+
+        Status = RunLayout( &Context, &Layouts[Index], Threads, AllSamples );
+
+        if (Status != ERROR_SUCCESS) {
+
+            break;
+        }
+    }
+
+    //
+    //  Put the parameters back and restart once more, so the RAM disk is
+    //  left the way we found it.
+    //
+
+    RestoreLayout( SavedValues, SavedPresent );
+    RestartRamdisk();
+
+Cleanup:
+
+    for (Index = 0; Index < Context.Threads; Index += 1) {
+
+        if (Threads[Index].IoBuffer != NULL) {
+
+            VirtualFree( Threads[Index].IoBuffer, 0, MEM_RELEASE );
+        }
+
+        free( Threads[Index].Samples );
+    }
+
+    free( AllSamples );
+
+    return (Status == ERROR_SUCCESS) ? SUCCESS : WORKLOAD_ERROR;
+}
@@ -0,0 +1,914 @@
+/*++
+
+Copyright (c) Microsoft Corporation, All Rights Reserved
+
+Module Name:
+
+    chunkstore.c
+
+Abstract:
+
+    This module implements the sparse backing store of the Ramdisk sample.
+
+    The disk image is described by a table with one pointer per chunk of
+    disk.  Nothing but the table is allocated when the device is added; a
+    chunk is allocated the first time any sector inside it is written.  Reads from a chunk that has
+    never been written are satisfied with zeros, and a trim that covers a
+    whole chunk gives the chunk back to the pool.
+
+    As a result a large ramdisk only consumes as much memory as the data
+    that has actually been stored on it, and device start no longer has to
+    zero the entire image.
+
+    When the queue dispatches requests in parallel, callers bracket their
+    accesses with RamDiskStoreLockRange/RamDiskStoreUnlockRange.  The range
+    locks are striped by chunk: reads take the stripes they touch shared,
+    writes and trims take them exclusive.  The range locks are also used
+    when the compressed tier (compress.c) is enabled, since its work item
+    runs concurrently with the queue.
+
+    By default chunks are 64 KB of nonpaged pool.  The LargePages registry
+    parameter switches to 2 MB chunks allocated physically contiguous and
+    2 MB aligned, so that the memory manager maps each chunk with a single
+    large page; if the first such chunk cannot be allocated the store falls
+    back to the default layout.  The NumaNode and NumaInterleave parameters
+    place chunks on one NUMA node or spread them round robin over all nodes.
+
+Environment:
+
+    Kernel mode only.
+
+--*/
+
+#include "ramdisk.h"
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, RamDiskStoreInitialize)
+#pragma alloc_text(PAGE, RamDiskStoreCleanup)
+#endif
+
+NTSTATUS
+RamDiskStoreInitialize(
+    IN PDEVICE_EXTENSION devExt
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates the chunk table for the disk size read from the
+    registry.  No chunks are allocated here.
+
+Arguments:
+
+    devExt - Supplies the device extension of the ramdisk.
+
+Return Value:
+
+    STATUS_SUCCESS or STATUS_INSUFFICIENT_RESOURCES.
+
+--*/
+
+{
+    SIZE_T tableSize;
+    PVOID  probe;
+    SIZE_T mapSize;
+
+    PAGED_CODE();
+
+    devExt->ChunkShift = RAMDISK_CHUNK_SHIFT;
+    devExt->RangeLocking = (devExt->DiskRegInfo.DispatchMode == RAMDISK_DISPATCH_PARALLEL ||
+                            devExt->DiskRegInfo.CompressAfterSeconds != 0);
+    devExt->ContiguousChunks = (devExt->DiskRegInfo.NumaNode != MM_ANY_NODE_OK ||
+                                devExt->DiskRegInfo.NumaInterleave != 0);
+    devExt->NodeCount = KeQueryHighestNodeNumber() + 1;
+
+    if (devExt->DiskRegInfo.LargePages != 0) {
+
+        //
+        // Make sure large chunks can be had at all before committing to
+        // the large page layout.
+        //
+        probe = MmAllocateContiguousNodeMemory(RAMDISK_LARGE_CHUNK_SIZE,
+                                               RtlConvertUlongToLargeInteger(0),
+                                               RtlConvertUlonglongToLargeInteger(MAXULONGLONG),
+                                               RtlConvertUlongToLargeInteger(RAMDISK_LARGE_CHUNK_SIZE),
+                                               PAGE_READWRITE,
+                                               MM_ANY_NODE_OK);
+        if (probe != NULL) {
+
+            MmFreeContiguousMemory(probe);
+            devExt->ChunkShift = RAMDISK_LARGE_CHUNK_SHIFT;
+            devExt->ContiguousChunks = TRUE;
+
+        } else {
+
+            KdPrint(("Large pages not available, using the default layout\n"));
+        }
+    }
+
+    devExt->ChunkCount = (ULONG)(((ULONGLONG)devExt->DiskRegInfo.DiskSize +
+                                  RAMDISK_CHUNK_MASK(devExt)) >> devExt->ChunkShift);
+    devExt->AllocatedChunks = 0;
+
+    RtlZeroMemory(devExt->RangeLocks, sizeof(devExt->RangeLocks));
+
+    tableSize = (SIZE_T)devExt->ChunkCount * sizeof(PUCHAR);
+
+    devExt->ChunkTable = ExAllocatePoolWithTag(NonPagedPool,
+                                               tableSize,
+                                               RAMDISK_TAG);
+
+    if (devExt->ChunkTable == NULL) {
+        devExt->ChunkCount = 0;
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(devExt->ChunkTable, tableSize);
+
+    if (devExt->ContiguousChunks) {
+
+        //
+        // One bit per chunk telling whether the chunk came from the
+        // contiguous allocator or from the pool fallback.
+        //
+        mapSize = ((devExt->ChunkCount + 31) / 32) * sizeof(LONG);
+
+        devExt->ContiguousChunkMap = ExAllocatePoolWithTag(NonPagedPool,
+                                                           mapSize,
+                                                           RAMDISK_TAG);
+        if (devExt->ContiguousChunkMap == NULL) {
+            ExFreePool(devExt->ChunkTable);
+            devExt->ChunkTable = NULL;
+            devExt->ChunkCount = 0;
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        RtlZeroMemory((PVOID)devExt->ContiguousChunkMap, mapSize);
+    }
+
+    KdPrint(("ChunkCount        = 0x%lx\n", devExt->ChunkCount));
+    KdPrint(("ChunkShift        = %lu\n",   devExt->ChunkShift));
+
+    return STATUS_SUCCESS;
+}
+
+static
+PUCHAR
+RamDiskStoreAllocateChunk(
+    IN PDEVICE_EXTENSION devExt,
+    IN ULONG ChunkIndex,
+    _Out_ PBOOLEAN Contiguous
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates the memory for one chunk according to the
+    layout chosen in RamDiskStoreInitialize.  Contiguous allocations that
+    fail are retried from nonpaged pool, so running short of large pages
+    only costs TLB efficiency, not disk space.
+
+Arguments:
+
+    devExt - Supplies the device extension of the ramdisk.
+
+    ChunkIndex - Supplies the index of the chunk, used to pick the NUMA
+                 node in interleaved mode.
+
+    Contiguous - Receives TRUE if the chunk came from the contiguous
+                 allocator and must be freed with MmFreeContiguousMemory.
+
+Return Value:
+
+    Pointer to the (not yet zeroed) chunk, or NULL.
+
+--*/
+
+{
+    PUCHAR           chunk;
+    NODE_REQUIREMENT node;
+    PHYSICAL_ADDRESS boundary;
+
+    *Contiguous = FALSE;
+
+    if (devExt->ContiguousChunks) {
+
+        if (devExt->DiskRegInfo.NumaInterleave != 0) {
+            node = ChunkIndex % devExt->NodeCount;
+        } else {
+            node = devExt->DiskRegInfo.NumaNode;
+        }
+
+        //
+        // A boundary equal to the chunk size keeps a large chunk from
+        // straddling a large page, i.e. makes it large page aligned.
+        //
+        boundary.QuadPart = (devExt->ChunkShift == RAMDISK_LARGE_CHUNK_SHIFT) ?
+                            RAMDISK_CHUNK_SIZE(devExt) : 0;
+
+        chunk = MmAllocateContiguousNodeMemory(RAMDISK_CHUNK_SIZE(devExt),
+                                               RtlConvertUlongToLargeInteger(0),
+                                               RtlConvertUlonglongToLargeInteger(MAXULONGLONG),
+                                               boundary,
+                                               PAGE_READWRITE,
+                                               node);
+        if (chunk != NULL) {
+            *Contiguous = TRUE;
+            return chunk;
+        }
+    }
+
+    return ExAllocatePoolWithTag(NonPagedPool,
+                                 RAMDISK_CHUNK_SIZE(devExt),
+                                 RAMDISK_TAG);
+}
+
+static
+VOID
+RamDiskStoreFreeChunk(
+    IN PDEVICE_EXTENSION devExt,
+    IN PUCHAR Chunk,
+    IN BOOLEAN Contiguous
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees the memory of one chunk.  Must be called at
+    PASSIVE_LEVEL for contiguous chunks.
+
+Arguments:
+
+    devExt - Supplies the device extension of the ramdisk.
+
+    Chunk - Supplies the chunk.
+
+    Contiguous - Supplies TRUE if the chunk came from the contiguous
+                 allocator.
+
+Return Value:
+
+    None
+
+--*/
+
+{
+    UNREFERENCED_PARAMETER(devExt);
+
+    if (Contiguous) {
+        MmFreeContiguousMemory(Chunk);
+    } else {
+        ExFreePool(Chunk);
+    }
+}
+
+static
+BOOLEAN
+RamDiskStoreTakeContiguousBit(
+    IN PDEVICE_EXTENSION devExt,
+    IN ULONG ChunkIndex
+    )
+
+/*++
+
+Routine Description:
+
+    This routine clears and returns the contiguous allocation bit of a
+    chunk that is being removed from the chunk table.
+
+Arguments:
+
+    devExt - Supplies the device extension of the ramdisk.
+
+    ChunkIndex - Supplies the index of the chunk.
+
+Return Value:
+
+    TRUE if the chunk must be freed with MmFreeContiguousMemory.
+
+--*/
+
+{
+    if (devExt->ContiguousChunkMap == NULL) {
+        return FALSE;
+    }
+
+    return InterlockedBitTestAndReset(&devExt->ContiguousChunkMap[ChunkIndex / 32],
+                                      ChunkIndex % 32);
+}
+
+VOID
+RamDiskStoreCleanup(
+    IN PDEVICE_EXTENSION devExt
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees every allocated chunk and the chunk table.
+
+Arguments:
+
+    devExt - Supplies the device extension of the ramdisk.
+
+Return Value:
+
+    None
+
+--*/
+
+{
+    ULONG i;
+
+    PAGED_CODE();
+
+    if (devExt->ChunkTable == NULL) {
+        return;
+    }
+
+    for (i = 0; i < devExt->ChunkCount; i++) {
+
+        if (devExt->ChunkTable[i] != NULL) {
+            RamDiskStoreFreeChunk(devExt,
+                                  devExt->ChunkTable[i],
+                                  RamDiskStoreTakeContiguousBit(devExt, i));
+            devExt->ChunkTable[i] = NULL;
+        }
+    }
+
+    if (devExt->ContiguousChunkMap != NULL) {
+        ExFreePool((PVOID)devExt->ContiguousChunkMap);
+        devExt->ContiguousChunkMap = NULL;
+    }
+
+    ExFreePool(devExt->ChunkTable);
+    devExt->ChunkTable = NULL;
+    devExt->ChunkCount = 0;
+    devExt->AllocatedChunks = 0;
+}
+
+static
+PUCHAR
+RamDiskStoreGetChunk(
+    IN PDEVICE_EXTENSION devExt,
+    IN ULONG ChunkIndex,
+    IN BOOLEAN Allocate,
+    _Out_ PNTSTATUS Status
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the memory backing a chunk, optionally allocating
+    a zeroed chunk if it has not been written yet.  A chunk that only lives
+    in the compressed tier is decompressed first.
+
+    The chunk pointer is published with an interlocked compare exchange so
+    that two writers racing for the same unallocated chunk end up sharing a
+    single allocation.
+
+Arguments:
+
+    devExt - Supplies the device extension of the ramdisk.
+
+    ChunkIndex - Supplies the index of the chunk.
+
+    Allocate - Supplies TRUE if a missing chunk should be allocated.
+
+    Status - Receives STATUS_SUCCESS, or the reason the chunk could not be
+             allocated or decompressed.
+
+Return Value:
+
+    Pointer to the chunk.  NULL with a success status means the chunk has
+    never been written and reads as zeros.
+
+--*/
+
+{
+    PUCHAR  chunk;
+    PUCHAR  existing;
+    BOOLEAN contiguous;
+
+    ASSERT(ChunkIndex < devExt->ChunkCount);
+
+    *Status = STATUS_SUCCESS;
+
+    if (devExt->ChunkStates != NULL) {
+        devExt->ChunkStates[ChunkIndex].LastAccess = RamDiskCompressionNow();
+    }
+
+    chunk = devExt->ChunkTable[ChunkIndex];
+
+    if (chunk == NULL && devExt->ChunkStates != NULL) {
+
+        chunk = RamDiskCompressionInflate(devExt, ChunkIndex, Status);
+        if (!NT_SUCCESS(*Status)) {
+            return NULL;
+        }
+    }
+
+    if (chunk != NULL || !Allocate) {
+        return chunk;
+    }
+
+    chunk = RamDiskStoreAllocateChunk(devExt, ChunkIndex, &contiguous);
+    if (chunk == NULL) {
+        *Status = STATUS_INSUFFICIENT_RESOURCES;
+        return NULL;
+    }
+
+    RtlZeroMemory(chunk, RAMDISK_CHUNK_SIZE(devExt));
+
+    existing = InterlockedCompareExchangePointer((PVOID volatile *)&devExt->ChunkTable[ChunkIndex],
+                                                 chunk,
+                                                 NULL);
+    if (existing != NULL) {
+
+        //
+        // Somebody else allocated the chunk first, use theirs.
+        //
+        RamDiskStoreFreeChunk(devExt, chunk, contiguous);
+        return existing;
+    }
+
+    if (contiguous) {
+        InterlockedBitTestAndSet(&devExt->ContiguousChunkMap[ChunkIndex / 32],
+                                 ChunkIndex % 32);
+    }
+
+    InterlockedIncrement(&devExt->AllocatedChunks);
+
+    return chunk;
+}
+
+NTSTATUS
+RamDiskStoreRead(
+    IN PDEVICE_EXTENSION devExt,
+    IN ULONG ByteOffset,
+    _Out_writes_bytes_(Length) PUCHAR Buffer,
+    IN ULONG Length
+    )
+
+/*++
+
+Routine Description:
+
+    This routine copies a range of the disk image to the caller's buffer,
+    walking chunk boundaries.  Unallocated chunks read back as zeros.
+
+Arguments:
+
+    devExt - Supplies the device extension of the ramdisk.
+
+    ByteOffset - Supplies the offset on the disk to start reading from.
+
+    Buffer - Supplies the buffer that receives the data.
+
+    Length - Supplies the number of bytes to read.
+
+Return Value:
+
+    STATUS_SUCCESS, or the status of a failed decompression.
+
+--*/
+
+{
+    ULONG    chunkIndex = ByteOffset >> devExt->ChunkShift;
+    ULONG    chunkOffset = ByteOffset & RAMDISK_CHUNK_MASK(devExt);
+    ULONG    bytes;
+    PUCHAR   chunk;
+    NTSTATUS status;
+
+    while (Length != 0) {
+
+        bytes = min(Length, RAMDISK_CHUNK_SIZE(devExt) - chunkOffset);
+
+        chunk = RamDiskStoreGetChunk(devExt, chunkIndex, FALSE, &status);
+
+        if (!NT_SUCCESS(status)) {
+            return status;
+        }
+
+        if (chunk != NULL) {
+            RtlCopyMemory(Buffer, chunk + chunkOffset, bytes);
+        } else {
+            RtlZeroMemory(Buffer, bytes);
+        }
+
+        Buffer += bytes;
+        Length -= bytes;
+        chunkIndex++;
+        chunkOffset = 0;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+RamDiskStoreWrite(
+    IN PDEVICE_EXTENSION devExt,
+    IN ULONG ByteOffset,
+    _In_reads_bytes_(Length) PUCHAR Buffer,
+    IN ULONG Length
+    )
+
+/*++
+
+Routine Description:
+
+    This routine copies the caller's buffer into the disk image, allocating
+    chunks that are written for the first time.
+
+Arguments:
+
+    devExt - Supplies the device extension of the ramdisk.
+
+    ByteOffset - Supplies the offset on the disk to start writing at.
+
+    Buffer - Supplies the data to write.
+
+    Length - Supplies the number of bytes to write.
+
+Return Value:
+
+    STATUS_SUCCESS, or STATUS_INSUFFICIENT_RESOURCES if a chunk could not
+    be allocated.  In the failure case the chunks preceding the failing one
+    have already been updated.
+
+--*/
+
+{
+    ULONG    chunkIndex = ByteOffset >> devExt->ChunkShift;
+    ULONG    chunkOffset = ByteOffset & RAMDISK_CHUNK_MASK(devExt);
+    ULONG    bytes;
+    PUCHAR   chunk;
+    NTSTATUS status;
+
+    while (Length != 0) {
+
+        bytes = min(Length, RAMDISK_CHUNK_SIZE(devExt) - chunkOffset);
+
+        chunk = RamDiskStoreGetChunk(devExt, chunkIndex, TRUE, &status);
+
+        if (chunk == NULL) {
+            return status;
+        }
+
+        RtlCopyMemory(chunk + chunkOffset, Buffer, bytes);
+
+        if (devExt->ChunkStates != NULL) {
+            RamDiskCompressionDiscardCompressed(devExt, chunkIndex);
+        }
+
+        Buffer += bytes;
+        Length -= bytes;
+        chunkIndex++;
+        chunkOffset = 0;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+RamDiskStoreDiscard(
+    IN PDEVICE_EXTENSION devExt,
+    IN ULONGLONG ByteOffset,
+    IN ULONGLONG Length,
+    _Inout_ PSINGLE_LIST_ENTRY DiscardedChunks
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles a trim of a range of the disk.  Chunks that are
+    entirely covered by the range are freed, the partially covered head and
+    tail of the range are zeroed so that they keep reading back as zeros.
+
+    The caller must make sure no read or write to the range is in progress,
+    either through the sequential queue or by holding the range exclusive.
+
+    Since the range lock is a spin lock and contiguous chunks can only be
+    freed at PASSIVE_LEVEL, chunks are not freed here but unlinked from the
+    table and put on the caller's list.  The caller frees them with
+    RamDiskStoreFreeDiscardedChunks once it has released the range.
+
+Arguments:
+
+    devExt - Supplies the device extension of the ramdisk.
+
+    ByteOffset - Supplies the offset of the range on the disk.
+
+    Length - Supplies the length of the range.
+
+    DiscardedChunks - Supplies the list the freed chunks are pushed on.
+
+Return Value:
+
+    None
+
+--*/
+
+{
+    ULONGLONG end;
+    ULONG     chunkIndex;
+    ULONG     chunkOffset;
+    ULONG     bytes;
+    PUCHAR    chunk;
+    NTSTATUS  status;
+    PRAMDISK_DISCARDED_CHUNK discarded;
+
+    if (ByteOffset >= devExt->DiskRegInfo.DiskSize) {
+        return;
+    }
+
+    end = min(ByteOffset + Length, (ULONGLONG)devExt->DiskRegInfo.DiskSize);
+
+    while (ByteOffset < end) {
+
+        chunkIndex = (ULONG)(ByteOffset >> devExt->ChunkShift);
+        chunkOffset = (ULONG)(ByteOffset & RAMDISK_CHUNK_MASK(devExt));
+        bytes = (ULONG)min(end - ByteOffset, (ULONGLONG)(RAMDISK_CHUNK_SIZE(devExt) - chunkOffset));
+
+        if (bytes == RAMDISK_CHUNK_SIZE(devExt)) {
+            chunk = devExt->ChunkTable[chunkIndex];
+        } else {
+
+            //
+            // A partially trimmed chunk that is compressed has to be
+            // decompressed to zero part of it. If that fails the chunk
+            // is left as it is, trim is only a hint.
+            //
+            chunk = RamDiskStoreGetChunk(devExt, chunkIndex, FALSE, &status);
+            if (!NT_SUCCESS(status)) {
+                ByteOffset += bytes;
+                continue;
+            }
+        }
+
+        if (devExt->ChunkStates != NULL) {
+            RamDiskCompressionDiscardCompressed(devExt, chunkIndex);
+        }
+
+        if (chunk != NULL) {
+
+            if (bytes == RAMDISK_CHUNK_SIZE(devExt)) {
+
+                devExt->ChunkTable[chunkIndex] = NULL;
+                InterlockedDecrement(&devExt->AllocatedChunks);
+
+                //
+                // The chunk's own memory holds the list entry.
+                //
+                discarded = (PRAMDISK_DISCARDED_CHUNK)chunk;
+                discarded->Contiguous = RamDiskStoreTakeContiguousBit(devExt, chunkIndex);
+                PushEntryList(DiscardedChunks, &discarded->ListEntry);
+
+            } else {
+
+                RtlZeroMemory(chunk + chunkOffset, bytes);
+            }
+        }
+
+        ByteOffset += bytes;
+    }
+}
+
+VOID
+RamDiskStoreFreeDiscardedChunks(
+    IN PDEVICE_EXTENSION devExt,
+    _Inout_ PSINGLE_LIST_ENTRY DiscardedChunks
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees the chunks unlinked by RamDiskStoreDiscard.
+
+Arguments:
+
+    devExt - Supplies the device extension of the ramdisk.
+
+    DiscardedChunks - Supplies the list filled in by RamDiskStoreDiscard.
+
+Return Value:
+
+    None
+
+--*/
+
+{
+    PSINGLE_LIST_ENTRY       entry;
+    PRAMDISK_DISCARDED_CHUNK discarded;
+
+    while ((entry = PopEntryList(DiscardedChunks)) != NULL) {
+
+        discarded = CONTAINING_RECORD(entry, RAMDISK_DISCARDED_CHUNK, ListEntry);
+        RamDiskStoreFreeChunk(devExt, (PUCHAR)discarded, discarded->Contiguous);
+    }
+}
+
+ULONG64
+RamDiskStoreLockRange(
+    IN PDEVICE_EXTENSION devExt,
+    IN ULONGLONG ByteOffset,
+    IN ULONGLONG Length,
+    IN BOOLEAN Exclusive,
+    _Out_ PKIRQL OldIrql
+    )
+
+/*++
+
+Routine Description:
+
+    This routine acquires the range lock stripes covering a range of the
+    disk.  It does nothing unless the device is in parallel dispatch mode
+    or has the compressed tier enabled; otherwise the sequential queue
+    already serializes all accesses.
+
+    Stripes are always acquired in ascending order so that two requests
+    needing overlapping sets of stripes cannot deadlock.
+
+Arguments:
+
+    devExt - Supplies the device extension of the ramdisk.
+
+    ByteOffset - Supplies the offset of the range on the disk.
+
+    Length - Supplies the length of the range, must not be zero.
+
+    Exclusive - Supplies TRUE to acquire the stripes for write access.
+
+    OldIrql - Receives the IRQL to be passed to RamDiskStoreUnlockRange.
+
+Return Value:
+
+    The mask of acquired stripes, to be passed to RamDiskStoreUnlockRange.
+
+--*/
+
+{
+    ULONG64   stripes = 0;
+    ULONGLONG firstChunk;
+    ULONGLONG lastChunk;
+    ULONG     i;
+    BOOLEAN   first = TRUE;
+
+    *OldIrql = PASSIVE_LEVEL;
+
+    if (!devExt->RangeLocking || Length == 0) {
+        return 0;
+    }
+
+    firstChunk = ByteOffset >> devExt->ChunkShift;
+    lastChunk = (ByteOffset + Length - 1) >> devExt->ChunkShift;
+
+    if (lastChunk - firstChunk + 1 >= RAMDISK_RANGE_LOCK_COUNT) {
+
+        stripes = MAXULONG64 >> (64 - RAMDISK_RANGE_LOCK_COUNT);
+
+    } else {
+
+        for (; firstChunk <= lastChunk; firstChunk++) {
+            stripes |= 1ULL << (firstChunk % RAMDISK_RANGE_LOCK_COUNT);
+        }
+    }
+
+    for (i = 0; i < RAMDISK_RANGE_LOCK_COUNT; i++) {
+
+        if ((stripes & (1ULL << i)) == 0) {
+            continue;
+        }
+
+        if (first) {
+
+            *OldIrql = Exclusive ?
+                       ExAcquireSpinLockExclusive(&devExt->RangeLocks[i].Lock) :
+                       ExAcquireSpinLockShared(&devExt->RangeLocks[i].Lock);
+            first = FALSE;
+
+        } else if (Exclusive) {
+
+            ExAcquireSpinLockExclusiveAtDpcLevel(&devExt->RangeLocks[i].Lock);
+
+        } else {
+
+            ExAcquireSpinLockSharedAtDpcLevel(&devExt->RangeLocks[i].Lock);
+        }
+    }
+
+    return stripes;
+}
+
+VOID
+RamDiskStoreUnlockRange(
+    IN PDEVICE_EXTENSION devExt,
+    IN ULONG64 Stripes,
+    IN BOOLEAN Exclusive,
+    IN KIRQL OldIrql
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases the stripes acquired by RamDiskStoreLockRange,
+    in the reverse order of acquisition.
+
+Arguments:
+
+    devExt - Supplies the device extension of the ramdisk.
+
+    Stripes - Supplies the mask returned by RamDiskStoreLockRange.
+
+    Exclusive - Supplies the value passed to RamDiskStoreLockRange.
+
+    OldIrql - Supplies the IRQL returned by RamDiskStoreLockRange.
+
+Return Value:
+
+    None
+
+--*/
+
+{
+    ULONG i;
+
+    for (i = RAMDISK_RANGE_LOCK_COUNT; i-- != 0; ) {
+
+        if ((Stripes & (1ULL << i)) == 0) {
+            continue;
+        }
+
+        Stripes &= ~(1ULL << i);
+
+        if (Stripes == 0) {
+
+            //
+            // This is the stripe that was acquired first.
+            //
+            if (Exclusive) {
+                ExReleaseSpinLockExclusive(&devExt->RangeLocks[i].Lock, OldIrql);
+            } else {
+                ExReleaseSpinLockShared(&devExt->RangeLocks[i].Lock, OldIrql);
+            }
+
+        } else if (Exclusive) {
+
+            ExReleaseSpinLockExclusiveFromDpcLevel(&devExt->RangeLocks[i].Lock);
+
+        } else {
+
+            ExReleaseSpinLockSharedFromDpcLevel(&devExt->RangeLocks[i].Lock);
+        }
+    }
+}
+
+PUCHAR
+RamDiskStoreGetSectorForWrite(
+    IN PDEVICE_EXTENSION devExt,
+    IN ULONG ByteOffset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns a pointer to a sector of the disk image, allocating
+    the chunk that holds it if needed.  It is used to lay down the on-disk
+    structures when the disk is formatted.
+
+Arguments:
+
+    devExt - Supplies the device extension of the ramdisk.
+
+    ByteOffset - Supplies the sector aligned offset of the sector.
+
+Return Value:
+
+    Pointer to the sector, or NULL if the chunk could not be allocated.
+
+--*/
+
+{
+    PUCHAR   chunk;
+    NTSTATUS status;
+
+    ASSERT((ByteOffset & (devExt->DiskGeometry.BytesPerSector - 1)) == 0);
+    ASSERT(devExt->ChunkStates == NULL);
+
+    chunk = RamDiskStoreGetChunk(devExt, ByteOffset >> devExt->ChunkShift, TRUE, &status);
+
+    if (chunk == NULL) {
+        return NULL;
+    }
+
+    return chunk + (ByteOffset & RAMDISK_CHUNK_MASK(devExt));
+}
@@ -0,0 +1,622 @@
+/*++
+
+Copyright (c) Microsoft Corporation, All Rights Reserved
+
+Module Name:
+
+    compress.c
+
+Abstract:
+
+    This module implements the optional compressed tier of the Ramdisk
+    sample's chunk store.
+
+    When the CompressAfterSeconds registry parameter is non-zero, a
+    periodic timer queues a work item that looks for chunks that have not
+    been read or written for that many seconds.  Such a chunk is LZNT1
+    compressed into a buffer of just the right size and its uncompressed
+    memory is freed.  Chunks that compress to all zeros are dropped
+    altogether, chunks that don't shrink by at least a quarter are left
+    alone.
+
+    The first read of a compressed chunk decompresses it back into a
+    regular chunk.  The compressed copy is kept around until the chunk is
+    written, so a chunk that goes cold again without having been modified
+    just drops its uncompressed memory without being compressed again.
+
+    Compression is done at PASSIVE_LEVEL on a snapshot of the chunk taken
+    under the shared range lock; the result is only installed if no write
+    happened to the chunk in between.
+
+Environment:
+
+    Kernel mode only.
+
+--*/
+
+#include "ramdisk.h"
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, RamDiskCompressionInitialize)
+#pragma alloc_text(PAGE, RamDiskCompressionCleanup)
+#endif
+
+#define RAMDISK_COMPRESSION_FORMAT      (COMPRESSION_FORMAT_LZNT1 | COMPRESSION_ENGINE_STANDARD)
+#define RAMDISK_COMPRESSION_UNIT        4096
+
+NTSTATUS
+RamDiskCompressionInitialize(
+    IN WDFDEVICE Device,
+    IN PDEVICE_EXTENSION devExt
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets up the compressed tier if it is enabled: the per
+    chunk state, the buffers used by the compression work item, the work
+    item itself and the timer that drives it.
+
+    It must be called after RamDiskStoreInitialize.
+
+Arguments:
+
+    Device - Supplies the framework device object of the ramdisk.
+
+    devExt - Supplies the device extension of the ramdisk.
+
+Return Value:
+
+    NTSTATUS
+
+--*/
+
+{
+    NTSTATUS              status;
+    ULONG                 workSpaceSize;
+    ULONG                 fragmentWorkSpaceSize;
+    ULONG                 period;
+    SIZE_T                stateSize;
+    WDF_TIMER_CONFIG      timerConfig;
+    WDF_WORKITEM_CONFIG   workItemConfig;
+    WDF_OBJECT_ATTRIBUTES attributes;
+
+    PAGED_CODE();
+
+    if (devExt->DiskRegInfo.CompressAfterSeconds == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    if (devExt->ContiguousChunks) {
+
+        //
+        // Decompressed chunks are always allocated from pool, which would
+        // defeat the large page and NUMA layouts.
+        //
+        KdPrint(("Compressed tier not supported with this memory layout, disabled\n"));
+        devExt->DiskRegInfo.CompressAfterSeconds = 0;
+        return STATUS_SUCCESS;
+    }
+
+    status = RtlGetCompressionWorkSpaceSize(RAMDISK_COMPRESSION_FORMAT,
+                                            &workSpaceSize,
+                                            &fragmentWorkSpaceSize);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    stateSize = (SIZE_T)devExt->ChunkCount * sizeof(RAMDISK_CHUNK_STATE);
+
+    devExt->ChunkStates = ExAllocatePoolWithTag(NonPagedPool, stateSize, RAMDISK_TAG);
+    devExt->CompressionScratch = ExAllocatePoolWithTag(NonPagedPool, RAMDISK_CHUNK_SIZE(devExt), RAMDISK_TAG);
+    devExt->CompressionOutput = ExAllocatePoolWithTag(NonPagedPool, RAMDISK_CHUNK_SIZE(devExt), RAMDISK_TAG);
+    devExt->CompressionWorkSpace = ExAllocatePoolWithTag(NonPagedPool, workSpaceSize, RAMDISK_TAG);
+
+    if (devExt->ChunkStates == NULL ||
+        devExt->CompressionScratch == NULL ||
+        devExt->CompressionOutput == NULL ||
+        devExt->CompressionWorkSpace == NULL) {
+
+        RamDiskCompressionCleanup(devExt);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(devExt->ChunkStates, stateSize);
+    RtlZeroMemory(&devExt->CompressionStats, sizeof(devExt->CompressionStats));
+
+    WDF_WORKITEM_CONFIG_INIT(&workItemConfig, RamDiskEvtCompressionWorkItem);
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject = Device;
+
+    status = WdfWorkItemCreate(&workItemConfig, &attributes, &devExt->CompressionWorkItem);
+    if (!NT_SUCCESS(status)) {
+        RamDiskCompressionCleanup(devExt);
+        return status;
+    }
+
+    //
+    // Scan twice per cold period, so a chunk gets compressed at most one
+    // and a half periods after its last access.
+    //
+    period = max(devExt->DiskRegInfo.CompressAfterSeconds / 2, 1);
+
+    WDF_TIMER_CONFIG_INIT_PERIODIC(&timerConfig, RamDiskEvtCompressionTimer, period * 1000);
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject = Device;
+
+    status = WdfTimerCreate(&timerConfig, &attributes, &devExt->CompressionTimer);
+    if (!NT_SUCCESS(status)) {
+        RamDiskCompressionCleanup(devExt);
+        return status;
+    }
+
+    WdfTimerStart(devExt->CompressionTimer, WDF_REL_TIMEOUT_IN_SEC(period));
+
+    KdPrint(("CompressAfterSeconds = %lu\n", devExt->DiskRegInfo.CompressAfterSeconds));
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+RamDiskCompressionCleanup(
+    IN PDEVICE_EXTENSION devExt
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees the compressed copies of all chunks and the
+    resources allocated by RamDiskCompressionInitialize.  The timer and
+    work item are children of the device and are deleted by the framework
+    before the device's cleanup callback runs.
+
+Arguments:
+
+    devExt - Supplies the device extension of the ramdisk.
+
+Return Value:
+
+    None
+
+--*/
+
+{
+    ULONG i;
+
+    PAGED_CODE();
+
+    if (devExt->ChunkStates != NULL) {
+
+        for (i = 0; i < devExt->ChunkCount; i++) {
+
+            if (devExt->ChunkStates[i].Compressed != NULL) {
+                ExFreePool(devExt->ChunkStates[i].Compressed);
+                devExt->ChunkStates[i].Compressed = NULL;
+            }
+        }
+
+        ExFreePool(devExt->ChunkStates);
+        devExt->ChunkStates = NULL;
+    }
+
+    if (devExt->CompressionScratch != NULL) {
+        ExFreePool(devExt->CompressionScratch);
+        devExt->CompressionScratch = NULL;
+    }
+
+    if (devExt->CompressionOutput != NULL) {
+        ExFreePool(devExt->CompressionOutput);
+        devExt->CompressionOutput = NULL;
+    }
+
+    if (devExt->CompressionWorkSpace != NULL) {
+        ExFreePool(devExt->CompressionWorkSpace);
+        devExt->CompressionWorkSpace = NULL;
+    }
+}
+
+LONG
+RamDiskCompressionNow(
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the current time in seconds, as used for the
+    last access time of chunks.
+
+--*/
+
+{
+    return (LONG)(KeQueryInterruptTime() / (10 * 1000 * 1000));
+}
+
+PUCHAR
+RamDiskCompressionInflate(
+    IN PDEVICE_EXTENSION devExt,
+    IN ULONG ChunkIndex,
+    _Out_ PNTSTATUS Status
+    )
+
+/*++
+
+Routine Description:
+
+    This routine decompresses a chunk that is only held in the compressed
+    tier and installs the result in the chunk table.  The compressed copy
+    is left in place.
+
+    The caller must hold the chunk's range lock, at least shared.  Two
+    readers inflating the same chunk at the same time are resolved with an
+    interlocked compare exchange on the chunk table entry.
+
+Arguments:
+
+    devExt - Supplies the device extension of the ramdisk.
+
+    ChunkIndex - Supplies the index of the chunk.
+
+    Status - Receives the status of the operation.
+
+Return Value:
+
+    Pointer to the chunk, or NULL if the chunk is not compressed (Status
+    is STATUS_SUCCESS) or could not be decompressed.
+
+--*/
+
+{
+    PRAMDISK_CHUNK_STATE state = &devExt->ChunkStates[ChunkIndex];
+    PUCHAR               chunk;
+    PUCHAR               existing;
+    ULONG                finalSize;
+    LARGE_INTEGER        start;
+    LARGE_INTEGER        end;
+    LARGE_INTEGER        frequency;
+    LONGLONG             elapsed;
+    LONGLONG             maxElapsed;
+
+    *Status = STATUS_SUCCESS;
+
+    if (state->Compressed == NULL) {
+        return NULL;
+    }
+
+    chunk = ExAllocatePoolWithTag(NonPagedPool, RAMDISK_CHUNK_SIZE(devExt), RAMDISK_TAG);
+    if (chunk == NULL) {
+        *Status = STATUS_INSUFFICIENT_RESOURCES;
+        return NULL;
+    }
+
+    start = KeQueryPerformanceCounter(&frequency);
+
+    *Status = RtlDecompressBuffer(RAMDISK_COMPRESSION_FORMAT,
+                                  chunk,
+                                  RAMDISK_CHUNK_SIZE(devExt),
+                                  state->Compressed,
+                                  state->CompressedSize,
+                                  &finalSize);
+
+    end = KeQueryPerformanceCounter(NULL);
+
+    if (!NT_SUCCESS(*Status)) {
+        ExFreePool(chunk);
+        return NULL;
+    }
+
+    if (finalSize < RAMDISK_CHUNK_SIZE(devExt)) {
+        RtlZeroMemory(chunk + finalSize, RAMDISK_CHUNK_SIZE(devExt) - finalSize);
+    }
+
+    existing = InterlockedCompareExchangePointer((PVOID volatile *)&devExt->ChunkTable[ChunkIndex],
+                                                 chunk,
+                                                 NULL);
+    if (existing != NULL) {
+        ExFreePool(chunk);
+        return existing;
+    }
+
+    InterlockedIncrement(&devExt->AllocatedChunks);
+
+    //
+    // Account the decompression latency in 100ns units.
+    //
+    elapsed = ((end.QuadPart - start.QuadPart) * 10 * 1000 * 1000) / frequency.QuadPart;
+
+    InterlockedIncrement64(&devExt->CompressionStats.Decompressions);
+    InterlockedAdd64(&devExt->CompressionStats.DecompressionTime, elapsed);
+
+    do {
+        maxElapsed = devExt->CompressionStats.MaxDecompressionTime;
+        if (elapsed <= maxElapsed) {
+            break;
+        }
+    } while (InterlockedCompareExchange64(&devExt->CompressionStats.MaxDecompressionTime,
+                                          elapsed,
+                                          maxElapsed) != maxElapsed);
+
+    return chunk;
+}
+
+VOID
+RamDiskCompressionDiscardCompressed(
+    IN PDEVICE_EXTENSION devExt,
+    IN ULONG ChunkIndex
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called when a chunk is written or trimmed.  It frees
+    the chunk's compressed copy, which no longer matches its contents, and
+    tells a concurrent compression pass that its snapshot is stale.
+
+    The caller must hold the chunk's range lock exclusive.
+
+Arguments:
+
+    devExt - Supplies the device extension of the ramdisk.
+
+    ChunkIndex - Supplies the index of the chunk.
+
+Return Value:
+
+    None
+
+--*/
+
+{
+    PRAMDISK_CHUNK_STATE state = &devExt->ChunkStates[ChunkIndex];
+
+    InterlockedIncrement(&state->WriteSequence);
+
+    if (state->Compressed != NULL) {
+
+        InterlockedDecrement(&devExt->CompressedChunks);
+        InterlockedAdd64(&devExt->CompressionStats.UncompressedBytes, -(LONGLONG)RAMDISK_CHUNK_SIZE(devExt));
+        InterlockedAdd64(&devExt->CompressionStats.CompressedBytes, -(LONGLONG)state->CompressedSize);
+
+        ExFreePool(state->Compressed);
+        state->Compressed = NULL;
+        state->CompressedSize = 0;
+    }
+}
+
+VOID
+RamDiskEvtCompressionTimer(
+    IN WDFTIMER Timer
+    )
+
+/*++
+
+Routine Description:
+
+    Periodic timer callback, queues the compression work item.  If the
+    previous pass is still running the enqueue is a no-op.
+
+Arguments:
+
+    Timer - Handle to the framework timer object.
+
+Return Value:
+
+    VOID
+
+--*/
+
+{
+    PDEVICE_EXTENSION devExt = DeviceGetExtension(WdfTimerGetParentObject(Timer));
+
+    WdfWorkItemEnqueue(devExt->CompressionWorkItem);
+}
+
+VOID
+RamDiskEvtCompressionWorkItem(
+    IN WDFWORKITEM WorkItem
+    )
+
+/*++
+
+Routine Description:
+
+    This routine makes one pass over the chunk table and moves the chunks
+    that have gone cold to the compressed tier.
+
+    Only one instance of the work item runs at a time, so the scratch
+    buffers in the device extension need no further protection.
+
+    This routine runs at PASSIVE_LEVEL but is not pageable, since it
+    acquires the range locks.
+
+Arguments:
+
+    WorkItem - Handle to the framework work item object.
+
+Return Value:
+
+    VOID
+
+--*/
+
+{
+    PDEVICE_EXTENSION    devExt = DeviceGetExtension(WdfWorkItemGetParentObject(WorkItem));
+    ULONG                chunkSize = RAMDISK_CHUNK_SIZE(devExt);
+    ULONG                i;
+    PRAMDISK_CHUNK_STATE state;
+    PUCHAR               chunk;
+    PUCHAR               compressed;
+    ULONG                compressedSize;
+    LONG                 sequence;
+    LONG                 now;
+    ULONG64              stripes;
+    KIRQL                oldIrql;
+    NTSTATUS             status;
+    BOOLEAN              installed;
+
+    for (i = 0; i < devExt->ChunkCount; i++) {
+
+        state = &devExt->ChunkStates[i];
+        now = RamDiskCompressionNow();
+
+        chunk = devExt->ChunkTable[i];
+
+        if (chunk == NULL ||
+            now - state->LastAccess < (LONG)devExt->DiskRegInfo.CompressAfterSeconds) {
+            continue;
+        }
+
+        if (state->Compressed != NULL) {
+
+            //
+            // The chunk was inflated by a read and hasn't been written
+            // since, the compressed copy is still good.
+            //
+            stripes = RamDiskStoreLockRange(devExt, (ULONGLONG)i << devExt->ChunkShift, chunkSize, TRUE, &oldIrql);
+
+            installed = (devExt->ChunkTable[i] == chunk && state->Compressed != NULL);
+            if (installed) {
+                devExt->ChunkTable[i] = NULL;
+                InterlockedDecrement(&devExt->AllocatedChunks);
+            }
+
+            RamDiskStoreUnlockRange(devExt, stripes, TRUE, oldIrql);
+
+            if (installed) {
+                ExFreePool(chunk);
+            }
+
+            continue;
+        }
+
+        //
+        // Take a snapshot of the chunk and compress it without holding
+        // the range lock.
+        //
+        stripes = RamDiskStoreLockRange(devExt, (ULONGLONG)i << devExt->ChunkShift, chunkSize, FALSE, &oldIrql);
+
+        sequence = state->WriteSequence;
+        chunk = devExt->ChunkTable[i];
+        if (chunk != NULL) {
+            RtlCopyMemory(devExt->CompressionScratch, chunk, chunkSize);
+        }
+
+        RamDiskStoreUnlockRange(devExt, stripes, FALSE, oldIrql);
+
+        if (chunk == NULL) {
+            continue;
+        }
+
+        status = RtlCompressBuffer(RAMDISK_COMPRESSION_FORMAT,
+                                   devExt->CompressionScratch,
+                                   chunkSize,
+                                   devExt->CompressionOutput,
+                                   chunkSize,
+                                   RAMDISK_COMPRESSION_UNIT,
+                                   &compressedSize,
+                                   devExt->CompressionWorkSpace);
+
+        if (status == STATUS_BUFFER_ALL_ZEROS) {
+
+            //
+            // An all zero chunk reads back the same without any memory.
+            //
+            compressed = NULL;
+            compressedSize = 0;
+
+        } else if (!NT_SUCCESS(status) ||
+                   compressedSize > chunkSize - chunkSize / 4) {
+
+            //
+            // Not worth it. Don't look at the chunk again until it has
+            // been cold for another full period.
+            //
+            InterlockedIncrement64(&devExt->CompressionStats.IncompressibleChunks);
+            state->LastAccess = now;
+            continue;
+
+        } else {
+
+            compressed = ExAllocatePoolWithTag(NonPagedPool, compressedSize, RAMDISK_TAG);
+            if (compressed == NULL) {
+                break;
+            }
+
+            RtlCopyMemory(compressed, devExt->CompressionOutput, compressedSize);
+        }
+
+        //
+        // Install the compressed copy unless the chunk was written or
+        // trimmed in the meantime.
+        //
+        stripes = RamDiskStoreLockRange(devExt, (ULONGLONG)i << devExt->ChunkShift, chunkSize, TRUE, &oldIrql);
+
+        installed = (devExt->ChunkTable[i] == chunk &&
+                     state->WriteSequence == sequence &&
+                     state->Compressed == NULL);
+
+        if (installed) {
+
+            devExt->ChunkTable[i] = NULL;
+            InterlockedDecrement(&devExt->AllocatedChunks);
+
+            if (compressed != NULL) {
+                state->Compressed = compressed;
+                state->CompressedSize = compressedSize;
+                InterlockedIncrement(&devExt->CompressedChunks);
+                InterlockedAdd64(&devExt->CompressionStats.UncompressedBytes, chunkSize);
+                InterlockedAdd64(&devExt->CompressionStats.CompressedBytes, compressedSize);
+            }
+
+            InterlockedIncrement64(&devExt->CompressionStats.Compressions);
+        }
+
+        RamDiskStoreUnlockRange(devExt, stripes, TRUE, oldIrql);
+
+        if (installed) {
+            ExFreePool(chunk);
+        } else if (compressed != NULL) {
+            ExFreePool(compressed);
+        }
+    }
+}
+
+VOID
+RamDiskCompressionQueryStatistics(
+    IN PDEVICE_EXTENSION devExt,
+    _Out_ PRAMDISK_COMPRESSION_STATISTICS Statistics
+    )
+
+/*++
+
+Routine Description:
+
+    This routine fills in the answer to
+    IOCTL_RAMDISK_QUERY_COMPRESSION_STATISTICS.
+
+Arguments:
+
+    devExt - Supplies the device extension of the ramdisk.
+
+    Statistics - Receives the statistics.
+
+Return Value:
+
+    None
+
+--*/
+
+{
+    *Statistics = devExt->CompressionStats;
+
+    Statistics->Version              = sizeof(RAMDISK_COMPRESSION_STATISTICS);
+    Statistics->CompressAfterSeconds = devExt->DiskRegInfo.CompressAfterSeconds;
+    Statistics->ChunkSize            = RAMDISK_CHUNK_SIZE(devExt);
+    Statistics->AllocatedChunks      = (ULONG)devExt->AllocatedChunks;
+    Statistics->CompressedChunks     = (ULONG)devExt->CompressedChunks;
+    Statistics->Reserved             = 0;
+}
@@ -0,0 +1,51 @@
+/*++
+
+Copyright (c) Microsoft Corporation, All Rights Reserved
+
+Module Name:
+
+    public.h
+
+Abstract:
+
+    Defines the private IOCTL codes of the Ramdisk sample and the data
+    structures they return.  This file is shared between the driver and
+    user mode applications.
+
+Environment:
+
+    User and kernel mode.
+
+--*/
+
+#pragma once
+
+//
+// The IOCTL function codes from 0x800 to 0xFFF are for customer use.
+//
+#define IOCTL_RAMDISK_QUERY_COMPRESSION_STATISTICS \
+    CTL_CODE( FILE_DEVICE_DISK, 0x800, METHOD_BUFFERED, FILE_READ_ACCESS )
+
+//
+// Returned by IOCTL_RAMDISK_QUERY_COMPRESSION_STATISTICS.
+//
+// The compression ratio of the cold tier is
+// UncompressedBytes / CompressedBytes, and the average decompression
+// latency is DecompressionTime / Decompressions.
+//
+typedef struct _RAMDISK_COMPRESSION_STATISTICS {
+    ULONG       Version;                // sizeof(RAMDISK_COMPRESSION_STATISTICS)
+    ULONG       CompressAfterSeconds;   // 0 if the compressed tier is disabled
+    ULONG       ChunkSize;              // Bytes of disk per chunk
+    ULONG       AllocatedChunks;        // Chunks held uncompressed
+    ULONG       CompressedChunks;       // Chunks held in the compressed tier
+    ULONG       Reserved;
+    LONGLONG    UncompressedBytes;      // Logical bytes in the compressed tier
+    LONGLONG    CompressedBytes;        // Memory used by the compressed tier
+    LONGLONG    Compressions;           // Chunks compressed since start
+    LONGLONG    IncompressibleChunks;   // Chunks left alone since they didn't shrink enough
+    LONGLONG    Decompressions;         // Chunks decompressed since start
+    LONGLONG    DecompressionTime;      // Total decompression time, in 100ns units
+    LONGLONG    MaxDecompressionTime;   // Longest decompression, in 100ns units
+} RAMDISK_COMPRESSION_STATISTICS, *PRAMDISK_COMPRESSION_STATISTICS;
+
@@ -14,6 +14,9 @@ Abstract:
     find the device in the disk manager and format the media to use
     as FAT or NTFS volume.
 
+    The nonpaged pool backing the media is allocated on demand in chunks,
+    see chunkstore.c.
+
 Environment:
 
     Kernel mode only.
@@ -102,7 +105,9 @@ Return Value:
     NTSTATUS               Status = STATUS_INVALID_PARAMETER;
     WDF_REQUEST_PARAMETERS Parameters;
     LARGE_INTEGER          ByteOffset;
-    WDFMEMORY              hMemory;
+    PUCHAR                 Buffer;
+    ULONG64                Stripes;
+    KIRQL                  OldIrql;
 
     _Analysis_assume_(Length > 0);
 
@@ -113,13 +118,17 @@ Return Value:
 
     if (RamDiskCheckParameters(devExt, ByteOffset, Length)) {
 
-        Status = WdfRequestRetrieveOutputMemory(Request, &hMemory);
+        Status = WdfRequestRetrieveOutputBuffer(Request, Length, &Buffer, NULL);
         if(NT_SUCCESS(Status)){
 
-            Status = WdfMemoryCopyFromBuffer(hMemory,   // Destination
-                                             0,         // Offset into the destination
-                                             devExt->DiskImage + ByteOffset.LowPart, // source
-                                             Length);
+            Stripes = RamDiskStoreLockRange(devExt, ByteOffset.QuadPart, Length, FALSE, &OldIrql);
+
+            Status = RamDiskStoreRead(devExt,
+                                      ByteOffset.LowPart,    // source offset on the disk
+                                      Buffer,                // destination
+                                      (ULONG)Length);
+
+            RamDiskStoreUnlockRange(devExt, Stripes, FALSE, OldIrql);
         }
     }
 
@@ -162,7 +171,9 @@ Return Value:
     NTSTATUS               Status = STATUS_INVALID_PARAMETER;
     WDF_REQUEST_PARAMETERS Parameters;
     LARGE_INTEGER          ByteOffset;
-    WDFMEMORY              hMemory;
+    PUCHAR                 Buffer;
+    ULONG64                Stripes;
+    KIRQL                  OldIrql;
 
     _Analysis_assume_(Length > 0);
 
@@ -173,13 +184,17 @@ Return Value:
 
     if (RamDiskCheckParameters(devExt, ByteOffset, Length)) {
 
-        Status = WdfRequestRetrieveInputMemory(Request, &hMemory);
+        Status = WdfRequestRetrieveInputBuffer(Request, Length, &Buffer, NULL);
         if(NT_SUCCESS(Status)){
 
-            Status = WdfMemoryCopyToBuffer(hMemory, // Source
-                                    0,              // offset in Source memory where the copy has to start
-                                    devExt->DiskImage + ByteOffset.LowPart, // destination
-                                    Length);
+            Stripes = RamDiskStoreLockRange(devExt, ByteOffset.QuadPart, Length, TRUE, &OldIrql);
+
+            Status = RamDiskStoreWrite(devExt,
+                                       ByteOffset.LowPart,  // destination offset on the disk
+                                       Buffer,              // source
+                                       (ULONG)Length);
+
+            RamDiskStoreUnlockRange(devExt, Stripes, TRUE, OldIrql);
         }
 
     }
@@ -235,15 +250,30 @@ Return Value:
     case IOCTL_DISK_GET_PARTITION_INFO: {
 
             PPARTITION_INFORMATION outputBuffer;
-            PBOOT_SECTOR bootSector = (PBOOT_SECTOR) devExt->DiskImage;
+            CCHAR fatType;
+            ULONG64 stripes;
+            KIRQL oldIrql;
 
             information = sizeof(PARTITION_INFORMATION);
 
             Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(PARTITION_INFORMATION), &outputBuffer, &bufSize);
             if(NT_SUCCESS(Status) ) {
 
+                stripes = RamDiskStoreLockRange(devExt, 0, sizeof(BOOT_SECTOR), FALSE, &oldIrql);
+
+                Status = RamDiskStoreRead(devExt,
+                                          FIELD_OFFSET(BOOT_SECTOR, bsFileSystemType[4]),
+                                          (PUCHAR)&fatType,
+                                          sizeof(fatType));
+
+                RamDiskStoreUnlockRange(devExt, stripes, FALSE, oldIrql);
+
+                if (!NT_SUCCESS(Status)) {
+                    break;
+                }
+
                 outputBuffer->PartitionType =
-                    (bootSector->bsFileSystemType[4] == '6') ? PARTITION_FAT_16 : PARTITION_FAT_12;
+                    (fatType == '6') ? PARTITION_FAT_16 : PARTITION_FAT_12;
 
                 outputBuffer->BootIndicator       = FALSE;
                 outputBuffer->RecognizedPartition = TRUE;
@@ -278,6 +308,122 @@ Return Value:
         }
         break;
 
+    case IOCTL_STORAGE_QUERY_PROPERTY: {
+
+            PSTORAGE_PROPERTY_QUERY     query;
+            PDEVICE_TRIM_DESCRIPTOR     trimDescriptor;
+
+            //
+            // Only the trim property is answered, so that file systems
+            // tell us about freed space and empty chunks can be released.
+            //
+            Status = WdfRequestRetrieveInputBuffer(Request, sizeof(STORAGE_PROPERTY_QUERY), &query, &bufSize);
+            if(!NT_SUCCESS(Status)) {
+                break;
+            }
+
+            if (query->PropertyId != StorageDeviceTrimProperty) {
+                Status = STATUS_NOT_SUPPORTED;
+                break;
+            }
+
+            if (query->QueryType == PropertyExistsQuery) {
+                Status = STATUS_SUCCESS;
+                break;
+            }
+
+            if (query->QueryType != PropertyStandardQuery) {
+                Status = STATUS_NOT_SUPPORTED;
+                break;
+            }
+
+            Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(DEVICE_TRIM_DESCRIPTOR), &trimDescriptor, &bufSize);
+            if(NT_SUCCESS(Status)) {
+
+                RtlZeroMemory(trimDescriptor, sizeof(DEVICE_TRIM_DESCRIPTOR));
+                trimDescriptor->Version     = sizeof(DEVICE_TRIM_DESCRIPTOR);
+                trimDescriptor->Size        = sizeof(DEVICE_TRIM_DESCRIPTOR);
+                trimDescriptor->TrimEnabled = TRUE;
+
+                information = sizeof(DEVICE_TRIM_DESCRIPTOR);
+            }
+        }
+        break;
+
+    case IOCTL_STORAGE_MANAGE_DATA_SET_ATTRIBUTES: {
+
+            PDEVICE_MANAGE_DATA_SET_ATTRIBUTES dsmAttributes;
+            PDEVICE_DATA_SET_RANGE             ranges;
+            ULONG                              rangeCount;
+            ULONG                              i;
+            ULONG64                            stripes;
+            KIRQL                              oldIrql;
+            SINGLE_LIST_ENTRY                  discardedChunks;
+
+            Status = WdfRequestRetrieveInputBuffer(Request, sizeof(DEVICE_MANAGE_DATA_SET_ATTRIBUTES), &dsmAttributes, &bufSize);
+            if(!NT_SUCCESS(Status)) {
+                break;
+            }
+
+            if (dsmAttributes->Action != DeviceDsmAction_Trim) {
+                Status = STATUS_NOT_SUPPORTED;
+                break;
+            }
+
+            if (dsmAttributes->DataSetRangesOffset < sizeof(DEVICE_MANAGE_DATA_SET_ATTRIBUTES) ||
+                dsmAttributes->DataSetRangesOffset > bufSize ||
+                dsmAttributes->DataSetRangesLength > bufSize - dsmAttributes->DataSetRangesOffset ||
+                (dsmAttributes->DataSetRangesOffset & (TYPE_ALIGNMENT(DEVICE_DATA_SET_RANGE) - 1)) != 0) {
+
+                Status = STATUS_INVALID_PARAMETER;
+                break;
+            }
+
+            ranges = (PDEVICE_DATA_SET_RANGE)((PUCHAR)dsmAttributes + dsmAttributes->DataSetRangesOffset);
+            rangeCount = dsmAttributes->DataSetRangesLength / sizeof(DEVICE_DATA_SET_RANGE);
+            discardedChunks.Next = NULL;
+
+            for (i = 0; i < rangeCount; i++) {
+
+                if (ranges[i].StartingOffset < 0 ||
+                    ranges[i].LengthInBytes == 0) {
+                    continue;
+                }
+
+                stripes = RamDiskStoreLockRange(devExt,
+                                                (ULONGLONG)ranges[i].StartingOffset,
+                                                ranges[i].LengthInBytes,
+                                                TRUE,
+                                                &oldIrql);
+
+                RamDiskStoreDiscard(devExt,
+                                    (ULONGLONG)ranges[i].StartingOffset,
+                                    ranges[i].LengthInBytes,
+                                    &discardedChunks);
+
+                RamDiskStoreUnlockRange(devExt, stripes, TRUE, oldIrql);
+            }
+
+            RamDiskStoreFreeDiscardedChunks(devExt, &discardedChunks);
+
+            Status = STATUS_SUCCESS;
+        }
+        break;
+
+    case IOCTL_RAMDISK_QUERY_COMPRESSION_STATISTICS: {
+
+            PRAMDISK_COMPRESSION_STATISTICS outputBuffer;
+
+            information = sizeof(RAMDISK_COMPRESSION_STATISTICS);
+
+            Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(RAMDISK_COMPRESSION_STATISTICS), &outputBuffer, &bufSize);
+            if(NT_SUCCESS(Status)) {
+
+                RamDiskCompressionQueryStatistics(devExt, outputBuffer);
+            }
+        }
+        break;
+
     case IOCTL_DISK_CHECK_VERIFY:
     case IOCTL_DISK_IS_WRITABLE:
 
@@ -304,9 +450,8 @@ Routine Description:
    EvtDeviceAdd, except those things that are automatically cleaned
    up by the Framework.
 
-   In the case of this sample, everything is automatically handled.  In a
-   driver derived from this sample, it's quite likely that this function could
-   be deleted.
+   In the case of this sample, only the compressed tier and the chunks
+   backing the disk image need to be freed.
 
 Arguments:
 
@@ -322,9 +467,8 @@ Return Value:
 
     PAGED_CODE();
 
-    if(pDeviceExtension->DiskImage) {
-        ExFreePool(pDeviceExtension->DiskImage);
-    }
+    RamDiskCompressionCleanup(pDeviceExtension);
+    RamDiskStoreCleanup(pDeviceExtension);
 }
 
 NTSTATUS
@@ -399,14 +543,33 @@ Return Value:
 
     pDeviceExtension = DeviceGetExtension(device);
 
+    //
+    // Now do any RAM-Disk specific initialization
+    //
+    pDeviceExtension->DiskRegInfo.DriveLetter.Buffer =
+        (PWSTR) &pDeviceExtension->DriveLetterBuffer;
+    pDeviceExtension->DiskRegInfo.DriveLetter.MaximumLength =
+        sizeof(pDeviceExtension->DriveLetterBuffer);
+
+    //
+    // Get the disk parameters from the registry
+    //
+    RamDiskQueryDiskRegParameters(
+        WdfDriverGetRegistryPath(WdfDeviceGetDriver(device)),
+        &pDeviceExtension->DiskRegInfo
+        );
+
     //
     // Configure a default queue so that requests that are not
     // configure-fowarded using WdfDeviceConfigureRequestDispatching to goto
-    // other queues get dispatched here.
+    // other queues get dispatched here. In parallel dispatch mode the range
+    // locks of the chunk store take over the serialization the sequential
+    // queue provides.
     //
     WDF_IO_QUEUE_CONFIG_INIT_DEFAULT_QUEUE (
         &ioQueueConfig,
-        WdfIoQueueDispatchSequential
+        (pDeviceExtension->DiskRegInfo.DispatchMode == RAMDISK_DISPATCH_PARALLEL) ?
+            WdfIoQueueDispatchParallel : WdfIoQueueDispatchSequential
         );
 
     ioQueueConfig.EvtIoDeviceControl = RamDiskEvtIoDeviceControl;
@@ -415,6 +578,18 @@ Return Value:
 
     WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&queueAttributes, QUEUE_EXTENSION);
 
+    //
+    // Chunks allocated contiguously can only be freed at PASSIVE_LEVEL,
+    // which trim requests do. Make sure they are never presented at
+    // DISPATCH_LEVEL.
+    //
+    if (pDeviceExtension->DiskRegInfo.LargePages != 0 ||
+        pDeviceExtension->DiskRegInfo.NumaNode != MM_ANY_NODE_OK ||
+        pDeviceExtension->DiskRegInfo.NumaInterleave != 0) {
+
+        queueAttributes.ExecutionLevel = WdfExecutionLevelPassive;
+    }
+
     //
     // By default, Static Driver Verifier (SDV) displays a warning if it 
     // doesn't find the EvtIoStop callback on a power-managed queue. 
@@ -465,39 +640,28 @@ Return Value:
 #endif
 
     //
-    // Now do any RAM-Disk specific initialization
+    // Allocate the chunk table for the disk image. The chunks themselves
+    // are allocated as the disk gets written.
     //
-    pDeviceExtension->DiskRegInfo.DriveLetter.Buffer =
-        (PWSTR) &pDeviceExtension->DriveLetterBuffer;
-    pDeviceExtension->DiskRegInfo.DriveLetter.MaximumLength =
-        sizeof(pDeviceExtension->DriveLetterBuffer);
+    status = RamDiskStoreInitialize(pDeviceExtension);
 
-    //
-    // Get the disk parameters from the registry
-    //
-    RamDiskQueryDiskRegParameters(
-        WdfDriverGetRegistryPath(WdfDeviceGetDriver(device)),
-        &pDeviceExtension->DiskRegInfo
-        );
+    if (NT_SUCCESS(status)) {
+        status = RamDiskFormatDisk(pDeviceExtension);
+    }
 
     //
-    // Allocate memory for the disk image.
+    // The compressed tier is set up after formatting, so the freshly
+    // written boot sector and FAT start out uncompressed.
     //
-    pDeviceExtension->DiskImage = ExAllocatePoolWithTag(
-        NonPagedPool,
-        pDeviceExtension->DiskRegInfo.DiskSize,
-        RAMDISK_TAG
-        );
+    if (NT_SUCCESS(status)) {
+        status = RamDiskCompressionInitialize(device, pDeviceExtension);
+    }
 
-    if (pDeviceExtension->DiskImage) {
+    if (NT_SUCCESS(status)) {
 
         UNICODE_STRING deviceName;
         UNICODE_STRING win32Name;
 
-        RamDiskFormatDisk(pDeviceExtension);
-
-        status = STATUS_SUCCESS;
-
         //
         // Now try to create a symbolic link for the drive letter.
         //
@@ -547,7 +711,7 @@ Return Value:
 
 {
 
-    RTL_QUERY_REGISTRY_TABLE rtlQueryRegTbl[5 + 1];  // Need 1 for NULL
+    RTL_QUERY_REGISTRY_TABLE rtlQueryRegTbl[10 + 1];  // Need 1 for NULL
     NTSTATUS                 Status;
     DISK_INFO                defDiskRegInfo;
 
@@ -560,6 +724,11 @@ Return Value:
     defDiskRegInfo.DiskSize          = DEFAULT_DISK_SIZE;
     defDiskRegInfo.RootDirEntries    = DEFAULT_ROOT_DIR_ENTRIES;
     defDiskRegInfo.SectorsPerCluster = DEFAULT_SECTORS_PER_CLUSTER;
+    defDiskRegInfo.DispatchMode      = DEFAULT_DISPATCH_MODE;
+    defDiskRegInfo.LargePages        = DEFAULT_LARGE_PAGES;
+    defDiskRegInfo.NumaNode          = DEFAULT_NUMA_NODE;
+    defDiskRegInfo.NumaInterleave    = DEFAULT_NUMA_INTERLEAVE;
+    defDiskRegInfo.CompressAfterSeconds = DEFAULT_COMPRESS_AFTER_SECONDS;
 
     RtlInitUnicodeString(&defDiskRegInfo.DriveLetter, DEFAULT_DRIVE_LETTER);
 
@@ -608,6 +777,44 @@ Return Value:
     rtlQueryRegTbl[4].DefaultData   = defDiskRegInfo.DriveLetter.Buffer;
     rtlQueryRegTbl[4].DefaultLength = 0;
 
+    rtlQueryRegTbl[5].Flags         = RTL_QUERY_REGISTRY_DIRECT;
+    rtlQueryRegTbl[5].Name          = L"DispatchMode";
+    rtlQueryRegTbl[5].EntryContext  = &DiskRegInfo->DispatchMode;
+    rtlQueryRegTbl[5].DefaultType   = REG_DWORD;
+    rtlQueryRegTbl[5].DefaultData   = &defDiskRegInfo.DispatchMode;
+    rtlQueryRegTbl[5].DefaultLength = sizeof(ULONG);
+
+    //
+    // Memory layout of the disk image
+    //
+
+    rtlQueryRegTbl[6].Flags         = RTL_QUERY_REGISTRY_DIRECT;
+    rtlQueryRegTbl[6].Name          = L"LargePages";
+    rtlQueryRegTbl[6].EntryContext  = &DiskRegInfo->LargePages;
+    rtlQueryRegTbl[6].DefaultType   = REG_DWORD;
+    rtlQueryRegTbl[6].DefaultData   = &defDiskRegInfo.LargePages;
+    rtlQueryRegTbl[6].DefaultLength = sizeof(ULONG);
+
+    rtlQueryRegTbl[7].Flags         = RTL_QUERY_REGISTRY_DIRECT;
+    rtlQueryRegTbl[7].Name          = L"NumaNode";
+    rtlQueryRegTbl[7].EntryContext  = &DiskRegInfo->NumaNode;
+    rtlQueryRegTbl[7].DefaultType   = REG_DWORD;
+    rtlQueryRegTbl[7].DefaultData   = &defDiskRegInfo.NumaNode;
+    rtlQueryRegTbl[7].DefaultLength = sizeof(ULONG);
+
+    rtlQueryRegTbl[8].Flags         = RTL_QUERY_REGISTRY_DIRECT;
+    rtlQueryRegTbl[8].Name          = L"NumaInterleave";
+    rtlQueryRegTbl[8].EntryContext  = &DiskRegInfo->NumaInterleave;
+    rtlQueryRegTbl[8].DefaultType   = REG_DWORD;
+    rtlQueryRegTbl[8].DefaultData   = &defDiskRegInfo.NumaInterleave;
+    rtlQueryRegTbl[8].DefaultLength = sizeof(ULONG);
+
+    rtlQueryRegTbl[9].Flags         = RTL_QUERY_REGISTRY_DIRECT;
+    rtlQueryRegTbl[9].Name          = L"CompressAfterSeconds";
+    rtlQueryRegTbl[9].EntryContext  = &DiskRegInfo->CompressAfterSeconds;
+    rtlQueryRegTbl[9].DefaultType   = REG_DWORD;
+    rtlQueryRegTbl[9].DefaultData   = &defDiskRegInfo.CompressAfterSeconds;
+    rtlQueryRegTbl[9].DefaultLength = sizeof(ULONG);
 
     Status = RtlQueryRegistryValues(
                  RTL_REGISTRY_ABSOLUTE | RTL_REGISTRY_OPTIONAL,
@@ -622,12 +829,22 @@ Return Value:
         DiskRegInfo->DiskSize          = defDiskRegInfo.DiskSize;
         DiskRegInfo->RootDirEntries    = defDiskRegInfo.RootDirEntries;
         DiskRegInfo->SectorsPerCluster = defDiskRegInfo.SectorsPerCluster;
+        DiskRegInfo->DispatchMode      = defDiskRegInfo.DispatchMode;
+        DiskRegInfo->LargePages        = defDiskRegInfo.LargePages;
+        DiskRegInfo->NumaNode          = defDiskRegInfo.NumaNode;
+        DiskRegInfo->NumaInterleave    = defDiskRegInfo.NumaInterleave;
+        DiskRegInfo->CompressAfterSeconds = defDiskRegInfo.CompressAfterSeconds;
         RtlCopyUnicodeString(&DiskRegInfo->DriveLetter, &defDiskRegInfo.DriveLetter);
     }
 
     KdPrint(("DiskSize          = 0x%lx\n", DiskRegInfo->DiskSize));
     KdPrint(("RootDirEntries    = 0x%lx\n", DiskRegInfo->RootDirEntries));
     KdPrint(("SectorsPerCluster = 0x%lx\n", DiskRegInfo->SectorsPerCluster));
+    KdPrint(("DispatchMode      = 0x%lx\n", DiskRegInfo->DispatchMode));
+    KdPrint(("LargePages        = 0x%lx\n", DiskRegInfo->LargePages));
+    KdPrint(("NumaNode          = 0x%lx\n", DiskRegInfo->NumaNode));
+    KdPrint(("NumaInterleave    = 0x%lx\n", DiskRegInfo->NumaInterleave));
+    KdPrint(("CompressAfterSeconds = 0x%lx\n", DiskRegInfo->CompressAfterSeconds));
     KdPrint(("DriveLetter       = %wZ\n",   &(DiskRegInfo->DriveLetter)));
 
     return;
@@ -657,7 +874,7 @@ Return Value:
 --*/
 {
 
-    PBOOT_SECTOR bootSector = (PBOOT_SECTOR) devExt->DiskImage;
+    PBOOT_SECTOR bootSector;
     PUCHAR       firstFatSector;
     ULONG        rootDirEntries;
     ULONG        sectorsPerCluster;
@@ -668,9 +885,13 @@ Return Value:
 
     PAGED_CODE();
     ASSERT(sizeof(BOOT_SECTOR) == 512);
-    ASSERT(devExt->DiskImage != NULL);
+    ASSERT(devExt->ChunkTable != NULL);
 
-    RtlZeroMemory(devExt->DiskImage, devExt->DiskRegInfo.DiskSize);
+    //
+    // The chunk table starts out empty, so the whole disk already reads
+    // back as zeros. Only the chunks holding the boot sector, the FAT and
+    // the root directory get allocated below.
+    //
 
     devExt->DiskGeometry.BytesPerSector = 512;
     devExt->DiskGeometry.SectorsPerTrack = 32;     // Using Ramdisk value
@@ -713,6 +934,11 @@ Return Value:
         rootDirEntries, sectorsPerCluster
         ));
 
+    bootSector = (PBOOT_SECTOR) RamDiskStoreGetSectorForWrite(devExt, 0);
+    if (bootSector == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
     //
     // We need to have the 0xeb and 0x90 since this is one of the
     // checks the file system recognizer uses
@@ -813,7 +1039,8 @@ Return Value:
     bootSector->bsSig2[1] = 0xAA;
 
     //
-    // The FAT is located immediately following the boot sector.
+    // The FAT is located immediately following the boot sector. Chunks are
+    // much larger than a sector, so it shares the boot sector's chunk.
     //
 
     firstFatSector    = (PUCHAR)(bootSector + 1);
@@ -828,7 +1055,12 @@ Return Value:
     //
     // The Root Directory follows the FAT
     //
-    rootDir = (PDIR_ENTRY)(bootSector + 1 + fatSectorCnt);
+    rootDir = (PDIR_ENTRY) RamDiskStoreGetSectorForWrite(
+                               devExt,
+                               (ULONG)((1 + fatSectorCnt) * sizeof(BOOT_SECTOR)));
+    if (rootDir == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
 
     //
     // Set device name to "MS-RAMDR"
@@ -21,7 +21,7 @@ Environment:
 
 #pragma warning(disable:4201)  // nameless struct/union warning
 
-#include <ntddk.h>
+#include <ntifs.h>                  // RtlCompressBuffer
 #include <ntdddisk.h>
 
 #pragma warning(default:4201)
@@ -30,6 +30,7 @@ Environment:
 #define NTSTRSAFE_LIB
 #include <ntstrsafe.h>
 #include "forward_progress.h"
+#include "public.h"
 
 #define NT_DEVICE_NAME                  L"\\Device\\Ramdisk"
 #define DOS_DEVICE_NAME                 L"\\DosDevices\\"
@@ -49,15 +50,116 @@ Environment:
 #define DEFAULT_SECTORS_PER_CLUSTER     2
 #define DEFAULT_DRIVE_LETTER            L"Z:"
 
+//
+// The disk image is kept as a table of fixed size chunks.  A chunk is only
+// allocated the first time a sector in it is written, sectors in chunks that
+// have never been written read back as zeros, and a trim of a whole chunk
+// returns its memory to the pool.
+//
+// The chunk size is picked when the device is added: 64 KB of pool by
+// default, or 2 MB, the size of one large page, when the LargePages
+// registry parameter is set and large pages are available.
+//
+#define RAMDISK_CHUNK_SHIFT             16                                  // 64 KB
+#define RAMDISK_LARGE_CHUNK_SHIFT       21                                  // 2 MB
+#define RAMDISK_LARGE_CHUNK_SIZE        (1UL << RAMDISK_LARGE_CHUNK_SHIFT)
+
+#define RAMDISK_CHUNK_SIZE(devExt)      (1UL << (devExt)->ChunkShift)
+#define RAMDISK_CHUNK_MASK(devExt)      (RAMDISK_CHUNK_SIZE(devExt) - 1)
+
+#define DEFAULT_LARGE_PAGES             0
+#define DEFAULT_NUMA_NODE               MM_ANY_NODE_OK  // No node preference
+#define DEFAULT_NUMA_INTERLEAVE         0
+
+//
+// Chunks that have not been accessed for CompressAfterSeconds are moved to
+// a compressed tier by a periodic work item (see compress.c).  Zero turns
+// the compressed tier off.
+//
+#define DEFAULT_COMPRESS_AFTER_SECONDS  0
+
+//
+// Values of the DispatchMode registry parameter.
+//
+// In sequential mode the default queue hands the driver one request at a
+// time, exactly like the original sample. In parallel mode the queue
+// dispatches requests concurrently and the chunks of the disk image are
+// protected by striped reader/writer range locks instead, so requests to
+// non-overlapping ranges run at the same time while a write excludes all
+// other requests touching the same chunks.
+//
+#define RAMDISK_DISPATCH_SEQUENTIAL     0
+#define RAMDISK_DISPATCH_PARALLEL       1
+#define DEFAULT_DISPATCH_MODE           RAMDISK_DISPATCH_SEQUENTIAL
+
+//
+// Number of range lock stripes; chunk N is protected by stripe
+// N % RAMDISK_RANGE_LOCK_COUNT.  Must not exceed 64, the stripes a request
+// needs are tracked in a ULONG64 mask.
+//
+#define RAMDISK_RANGE_LOCK_COUNT        64
+
 typedef struct _DISK_INFO {
     ULONG   DiskSize;           // Ramdisk size in bytes
     ULONG   RootDirEntries;     // No. of root directory entries
     ULONG   SectorsPerCluster;  // Sectors per cluster
+    ULONG   DispatchMode;       // RAMDISK_DISPATCH_XXX
+    ULONG   LargePages;         // Non-zero to back the image with large pages
+    ULONG   NumaNode;           // Node to allocate the image on, or MM_ANY_NODE_OK
+    ULONG   NumaInterleave;     // Non-zero to spread the image over all nodes
+    ULONG   CompressAfterSeconds; // Idle time before a chunk is compressed, 0 = never
     UNICODE_STRING DriveLetter; // Drive letter to be used
 } DISK_INFO, *PDISK_INFO;
 
+//
+// Each stripe lock sits on its own cache line so that processors working
+// on different stripes don't bounce the same line between them.
+//
+typedef struct _RAMDISK_RANGE_LOCK {
+    EX_SPIN_LOCK        Lock;
+    UCHAR               Reserved[SYSTEM_CACHE_ALIGNMENT_SIZE - sizeof(EX_SPIN_LOCK)];
+} RAMDISK_RANGE_LOCK, *PRAMDISK_RANGE_LOCK;
+
+//
+// A chunk freed by a trim is linked through its own memory until it can be
+// returned at PASSIVE_LEVEL.
+//
+typedef struct _RAMDISK_DISCARDED_CHUNK {
+    SINGLE_LIST_ENTRY   ListEntry;
+    BOOLEAN             Contiguous;
+} RAMDISK_DISCARDED_CHUNK, *PRAMDISK_DISCARDED_CHUNK;
+
+//
+// Per chunk state of the compressed tier.  A chunk may be held
+// uncompressed (ChunkTable), compressed, or both after a read brought a
+// compressed chunk back; Compressed is only changed under the exclusive
+// range lock of the chunk.
+//
+typedef struct _RAMDISK_CHUNK_STATE {
+    PUCHAR              Compressed;                 // LZNT1 copy of the chunk, or NULL
+    ULONG               CompressedSize;             // Size of the compressed copy
+    volatile LONG       LastAccess;                 // RamDiskCompressionNow() of the last access
+    volatile LONG       WriteSequence;              // Bumped by every write to the chunk
+} RAMDISK_CHUNK_STATE, *PRAMDISK_CHUNK_STATE;
+
 typedef struct _DEVICE_EXTENSION {
-    PUCHAR              DiskImage;                  // Pointer to beginning of disk image
+    PUCHAR             *ChunkTable;                 // Disk image, one pointer per chunk
+    ULONG               ChunkCount;                 // No. of entries in ChunkTable
+    ULONG               ChunkShift;                 // log2 of the chunk size
+    volatile LONG       AllocatedChunks;            // No. of chunks currently backed by memory
+    BOOLEAN             ContiguousChunks;           // Chunks come from MmAllocateContiguousNodeMemory
+    ULONG               NodeCount;                  // No. of NUMA nodes, for interleaving
+    volatile LONG      *ContiguousChunkMap;         // Bit set for chunks that are contiguous allocations
+    BOOLEAN             RangeLocking;               // Parallel dispatch or compressed tier enabled
+    RAMDISK_RANGE_LOCK  RangeLocks[RAMDISK_RANGE_LOCK_COUNT]; // Only used if RangeLocking
+    PRAMDISK_CHUNK_STATE ChunkStates;               // Compressed tier state, NULL if disabled
+    volatile LONG       CompressedChunks;           // No. of chunks with a compressed copy
+    PUCHAR              CompressionScratch;         // Snapshot of the chunk being compressed
+    PUCHAR              CompressionOutput;          // Output of RtlCompressBuffer
+    PVOID               CompressionWorkSpace;       // Workspace of RtlCompressBuffer
+    WDFWORKITEM         CompressionWorkItem;        // Compresses cold chunks at PASSIVE_LEVEL
+    WDFTIMER            CompressionTimer;           // Queues CompressionWorkItem periodically
+    RAMDISK_COMPRESSION_STATISTICS CompressionStats; // Counters for the statistics IOCTL
     DISK_GEOMETRY       DiskGeometry;               // Drive parameters built by Ramdisk
     DISK_INFO           DiskRegInfo;                // Disk parameters from the registry
     UNICODE_STRING      SymbolicLink;               // Dos symbolic name; Drive letter
@@ -135,6 +237,8 @@ EVT_WDF_DEVICE_CONTEXT_CLEANUP RamDiskEvtDeviceContextCleanup;
 EVT_WDF_IO_QUEUE_IO_READ RamDiskEvtIoRead;
 EVT_WDF_IO_QUEUE_IO_WRITE RamDiskEvtIoWrite;
 EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL RamDiskEvtIoDeviceControl;
+EVT_WDF_TIMER RamDiskEvtCompressionTimer;
+EVT_WDF_WORKITEM RamDiskEvtCompressionWorkItem;
 
 #else
 
@@ -185,6 +289,104 @@ RamDiskFormatDisk(
     IN PDEVICE_EXTENSION DeviceExtension
     );
 
+NTSTATUS
+RamDiskStoreInitialize(
+    IN PDEVICE_EXTENSION devExt
+    );
+
+VOID
+RamDiskStoreCleanup(
+    IN PDEVICE_EXTENSION devExt
+    );
+
+NTSTATUS
+RamDiskStoreRead(
+    IN PDEVICE_EXTENSION devExt,
+    IN ULONG ByteOffset,
+    _Out_writes_bytes_(Length) PUCHAR Buffer,
+    IN ULONG Length
+    );
+
+NTSTATUS
+RamDiskStoreWrite(
+    IN PDEVICE_EXTENSION devExt,
+    IN ULONG ByteOffset,
+    _In_reads_bytes_(Length) PUCHAR Buffer,
+    IN ULONG Length
+    );
+
+VOID
+RamDiskStoreDiscard(
+    IN PDEVICE_EXTENSION devExt,
+    IN ULONGLONG ByteOffset,
+    IN ULONGLONG Length,
+    _Inout_ PSINGLE_LIST_ENTRY DiscardedChunks
+    );
+
+VOID
+RamDiskStoreFreeDiscardedChunks(
+    IN PDEVICE_EXTENSION devExt,
+    _Inout_ PSINGLE_LIST_ENTRY DiscardedChunks
+    );
+
+ULONG64
+RamDiskStoreLockRange(
+    IN PDEVICE_EXTENSION devExt,
+    IN ULONGLONG ByteOffset,
+    IN ULONGLONG Length,
+    IN BOOLEAN Exclusive,
+    _Out_ PKIRQL OldIrql
+    );
+
+VOID
+RamDiskStoreUnlockRange(
+    IN PDEVICE_EXTENSION devExt,
+    IN ULONG64 Stripes,
+    IN BOOLEAN Exclusive,
+    IN KIRQL OldIrql
+    );
+
+PUCHAR
+RamDiskStoreGetSectorForWrite(
+    IN PDEVICE_EXTENSION devExt,
+    IN ULONG ByteOffset
+    );
+
+NTSTATUS
+RamDiskCompressionInitialize(
+    IN WDFDEVICE Device,
+    IN PDEVICE_EXTENSION devExt
+    );
+
+VOID
+RamDiskCompressionCleanup(
+    IN PDEVICE_EXTENSION devExt
+    );
+
+LONG
+RamDiskCompressionNow(
+    VOID
+    );
+
+PUCHAR
+RamDiskCompressionInflate(
+    IN PDEVICE_EXTENSION devExt,
+    IN ULONG ChunkIndex,
+    _Out_ PNTSTATUS Status
+    );
+
+VOID
+RamDiskCompressionDiscardCompressed(
+    IN PDEVICE_EXTENSION devExt,
+    IN ULONG ChunkIndex
+    );
+
+VOID
+RamDiskCompressionQueryStatistics(
+    IN PDEVICE_EXTENSION devExt,
+    _Out_ PRAMDISK_COMPRESSION_STATISTICS Statistics
+    );
+
 BOOLEAN
 RamDiskCheckParameters(
     IN PDEVICE_EXTENSION devExt,
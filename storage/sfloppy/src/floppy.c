@@ -45,6 +45,15 @@ Revision History:
 #define MODE_DATA_SIZE      192
 #define SCSI_FLOPPY_TIMEOUT  20
 #define SFLOPPY_SRB_LIST_SIZE 4
+
+//
+// Track cache defaults.  TrackCacheTracks in the device's hardware key
+// selects how many tracks one cache window holds: 0 disables the cache and
+// 0xFFFFFFFF caches the whole media, up to SFLOPPY_TRACK_CACHE_MAX_BYTES.
+//
+
+#define SFLOPPY_TRACK_CACHE_TRACKS_DEFAULT  1
+#define SFLOPPY_TRACK_CACHE_MAX_BYTES       (3 * 1024 * 1024)
 //
 // Define all possible drive/media combinations, given drives listed above
 // and media types in ntdddisk.h.
@@ -218,6 +227,24 @@ typedef struct _DISK_DATA {
     BOOLEAN IsDMF;
     // BOOLEAN EnableDMF;
     UNICODE_STRING FloppyInterfaceString;
+
+    //
+    // Track cache.  The lock protects everything below except the buffer
+    // contents, which are only written by the fill while the cache is not
+    // valid.  Generation is bumped by every invalidation so that a fill
+    // which raced with a write or a media change is discarded.
+    //
+
+    KSPIN_LOCK TrackCacheLock;
+    ULONG TrackCacheTracks;
+    PUCHAR TrackCacheBuffer;
+    ULONG TrackCacheBufferSize;
+    BOOLEAN TrackCacheValid;
+    LONG TrackCacheFilling;
+    ULONG TrackCacheGeneration;
+    ULONG TrackCacheMediaChangeCount;
+    LONGLONG TrackCacheOffset;
+    ULONG TrackCacheLength;
 } DISK_DATA, *PDISK_DATA;
 
 //
@@ -430,6 +457,24 @@ USBFlopFormatTracks(
     IN PIRP           Irp
     );
 
+VOID
+FlTrackCacheInvalidate(
+    IN PDEVICE_OBJECT DeviceObject
+    );
+
+BOOLEAN
+FlTrackCacheRead(
+    IN PDEVICE_OBJECT DeviceObject,
+    IN PIRP           Irp
+    );
+
+NTSTATUS
+FlTrackCacheFill(
+    IN PDEVICE_OBJECT DeviceObject,
+    IN LONGLONG       WindowOffset,
+    IN ULONG          WindowLength
+    );
+
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(INIT, DriverEntry)
 
@@ -697,6 +742,9 @@ Return Value:
     diskData->IsDMF = FALSE;
     // diskData->EnableDMF = TRUE;
 
+    KeInitializeSpinLock(&diskData->TrackCacheLock);
+    diskData->TrackCacheTracks = SFLOPPY_TRACK_CACHE_TRACKS_DEFAULT;
+
     //
     // Initialize lock count to zero. The lock count is used to
     // disable the ejection mechanism when media is mounted.
@@ -821,6 +869,16 @@ ScsiFlopInitDevice(
         fdoExtension->TimeOutValue = SCSI_FLOPPY_TIMEOUT;
     }
 
+    //
+    // Read the track cache size; the cache itself is allocated on first use
+    // since the track size depends on the media.
+    //
+
+    ClassGetDeviceParameter(fdoExtension,
+                            NULL,
+                            L"TrackCacheTracks",
+                            &diskData->TrackCacheTracks);
+
     //
     // Floppies are not partitionable so starting offset is 0.
     //
@@ -1033,6 +1091,7 @@ Return Value:
 
 {
     PFUNCTIONAL_DEVICE_EXTENSION fdoExtension = DeviceObject->DeviceExtension;
+    PDISK_DATA diskData = fdoExtension->CommonExtension.DriverData;
     PIO_STACK_LOCATION irpSp = IoGetCurrentIrpStackLocation(Irp);
     NTSTATUS status = STATUS_SUCCESS;
 
@@ -1046,6 +1105,387 @@ Return Value:
 
     Irp->IoStatus.Status = status;
 
+    //
+    // Writes invalidate the track cache; reads are served from it when
+    // possible.  A request completed from the cache belongs to us now, so
+    // tell classpnp not to touch it.
+    //
+
+    if (NT_SUCCESS(status) && (diskData->TrackCacheTracks != 0)) {
+
+        if (irpSp->MajorFunction == IRP_MJ_WRITE) {
+
+            FlTrackCacheInvalidate(DeviceObject);
+
+        } else if (FlTrackCacheRead(DeviceObject, Irp)) {
+
+            status = STATUS_PENDING;
+        }
+    }
+
+    return status;
+}
+
+
+VOID
+FlTrackCacheInvalidate(
+    IN PDEVICE_OBJECT DeviceObject
+    )
+
+/*++
+
+Routine Description:
+
+    This routine discards the contents of the track cache.  It is called for
+    every write, format and pass-through request and whenever the media type
+    is determined again.
+
+Arguments:
+
+    DeviceObject - the floppy device object
+
+Return Value:
+
+    None
+
+--*/
+
+{
+    PFUNCTIONAL_DEVICE_EXTENSION fdoExtension = DeviceObject->DeviceExtension;
+    PDISK_DATA diskData = fdoExtension->CommonExtension.DriverData;
+    KIRQL oldIrql;
+
+    KeAcquireSpinLock(&diskData->TrackCacheLock, &oldIrql);
+    diskData->TrackCacheValid = FALSE;
+    diskData->TrackCacheGeneration++;
+    KeReleaseSpinLock(&diskData->TrackCacheLock, oldIrql);
+}
+
+
+BOOLEAN
+FlTrackCacheRead(
+    IN PDEVICE_OBJECT DeviceObject,
+    IN PIRP           Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tries to complete a read request from the track cache.
+
+    The media is cached in windows of TrackCacheTracks whole tracks.  A read
+    that lies within one window is copied from the cache; if the window is
+    not cached and the caller runs at PASSIVE_LEVEL the whole window is read
+    from the device first, so the following sectors of that track are served
+    from memory.  Reads that are larger than a window, straddle two windows
+    or must go to the media are left to classpnp.
+
+Arguments:
+
+    DeviceObject - the floppy device object
+
+    Irp - the read request
+
+Return Value:
+
+    TRUE if the request was completed from the cache.
+
+--*/
+
+{
+    PFUNCTIONAL_DEVICE_EXTENSION fdoExtension = DeviceObject->DeviceExtension;
+    PDISK_DATA diskData = fdoExtension->CommonExtension.DriverData;
+    PIO_STACK_LOCATION irpSp = IoGetCurrentIrpStackLocation(Irp);
+    PDISK_GEOMETRY geometry = &fdoExtension->DiskGeometry;
+    LONGLONG offset = irpSp->Parameters.Read.ByteOffset.QuadPart;
+    ULONG length = irpSp->Parameters.Read.Length;
+    LONGLONG windowOffset;
+    ULONG windowLength;
+    ULONG trackLength;
+    ULONG tracks;
+    PUCHAR systemBuffer;
+    BOOLEAN hit = FALSE;
+    BOOLEAN retried = FALSE;
+    KIRQL oldIrql;
+
+    if ((length == 0) ||
+        (Irp->MdlAddress == NULL) ||
+        TEST_FLAG(irpSp->Flags, SL_FORCE_ACCESS) ||
+        (geometry->MediaType == Unknown) ||
+        (geometry->SectorsPerTrack == 0) ||
+        (geometry->BytesPerSector == 0) ||
+        (offset < 0) ||
+        (offset + length > fdoExtension->CommonExtension.PartitionLength.QuadPart)) {
+
+        return FALSE;
+    }
+
+    //
+    // Size the window in whole tracks.
+    //
+
+    trackLength = geometry->SectorsPerTrack * geometry->BytesPerSector;
+
+    if (trackLength > SFLOPPY_TRACK_CACHE_MAX_BYTES) {
+        return FALSE;
+    }
+
+    tracks = diskData->TrackCacheTracks;
+
+    if (tracks > SFLOPPY_TRACK_CACHE_MAX_BYTES / trackLength) {
+        tracks = SFLOPPY_TRACK_CACHE_MAX_BYTES / trackLength;
+    }
+
+    windowLength = tracks * trackLength;
+
+    if (length > windowLength) {
+        return FALSE;
+    }
+
+    windowOffset = (offset / windowLength) * windowLength;
+
+    if (offset + length > windowOffset + windowLength) {
+        return FALSE;
+    }
+
+    systemBuffer = MmGetSystemAddressForMdlSafe(Irp->MdlAddress, NormalPagePriority | MdlMappingNoExecute);
+
+    if (systemBuffer == NULL) {
+        return FALSE;
+    }
+
+    for (;;) {
+
+        KeAcquireSpinLock(&diskData->TrackCacheLock, &oldIrql);
+
+        if (diskData->TrackCacheValid &&
+            (diskData->TrackCacheMediaChangeCount == fdoExtension->MediaChangeCount) &&
+            (diskData->TrackCacheOffset == windowOffset) &&
+            (offset + length <= windowOffset + diskData->TrackCacheLength)) {
+
+            RtlCopyMemory(systemBuffer,
+                          diskData->TrackCacheBuffer + (offset - windowOffset),
+                          length);
+            hit = TRUE;
+        }
+
+        KeReleaseSpinLock(&diskData->TrackCacheLock, oldIrql);
+
+        if (hit || retried || (KeGetCurrentIrql() != PASSIVE_LEVEL)) {
+            break;
+        }
+
+        if (!NT_SUCCESS(FlTrackCacheFill(DeviceObject, windowOffset, windowLength))) {
+            break;
+        }
+
+        retried = TRUE;
+    }
+
+    if (!hit) {
+        return FALSE;
+    }
+
+    //
+    // ClassReadWrite returns STATUS_PENDING for requests it no longer
+    // owns, so mark the irp pending before completing it.
+    //
+
+    IoMarkIrpPending(Irp);
+
+    Irp->IoStatus.Status = STATUS_SUCCESS;
+    Irp->IoStatus.Information = length;
+
+    ClassReleaseRemoveLock(DeviceObject, Irp);
+    ClassCompleteRequest(DeviceObject, Irp, IO_DISK_INCREMENT);
+
+    return TRUE;
+}
+
+
+NTSTATUS
+FlTrackCacheFill(
+    IN PDEVICE_OBJECT DeviceObject,
+    IN LONGLONG       WindowOffset,
+    IN ULONG          WindowLength
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads one cache window from the device.  The window is read
+    as a stream of the largest reads the adapter accepts, which for a window
+    of one track is usually a single read.  Only one fill runs at a time;
+    concurrent misses simply go to the device.
+
+    This routine must be called at PASSIVE_LEVEL.
+
+Arguments:
+
+    DeviceObject - the floppy device object
+
+    WindowOffset - byte offset of the window on the media
+
+    WindowLength - size of the window in bytes
+
+Return Value:
+
+    NT Status
+
+--*/
+
+{
+    PFUNCTIONAL_DEVICE_EXTENSION fdoExtension = DeviceObject->DeviceExtension;
+    PDISK_DATA diskData = fdoExtension->CommonExtension.DriverData;
+    PSTORAGE_ADAPTER_DESCRIPTOR adapterDescriptor = fdoExtension->AdapterDescriptor;
+    ULONG bytesPerSector = fdoExtension->DiskGeometry.BytesPerSector;
+    PSCSI_REQUEST_BLOCK srb;
+    PCDB cdb;
+    ULONG generation;
+    ULONG mediaChangeCount;
+    ULONG maxTransfer;
+    ULONG transfer;
+    ULONG fillLength;
+    ULONG done;
+    ULONG lba;
+    ULONG blocks;
+    KIRQL oldIrql;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    if (InterlockedCompareExchange(&diskData->TrackCacheFilling, 1, 0) != 0) {
+        return STATUS_DEVICE_BUSY;
+    }
+
+    fillLength = WindowLength;
+
+    if (WindowOffset + fillLength > fdoExtension->CommonExtension.PartitionLength.QuadPart) {
+        fillLength = (ULONG)(fdoExtension->CommonExtension.PartitionLength.QuadPart - WindowOffset);
+        fillLength &= ~(bytesPerSector - 1);
+    }
+
+    //
+    // Nobody copies out of the buffer while the cache is invalid, so it may
+    // be replaced and filled without holding the lock.
+    //
+
+    KeAcquireSpinLock(&diskData->TrackCacheLock, &oldIrql);
+    diskData->TrackCacheValid = FALSE;
+    generation = diskData->TrackCacheGeneration;
+    mediaChangeCount = fdoExtension->MediaChangeCount;
+    KeReleaseSpinLock(&diskData->TrackCacheLock, oldIrql);
+
+    if (diskData->TrackCacheBufferSize < WindowLength) {
+
+        if (diskData->TrackCacheBuffer != NULL) {
+            ExFreePool(diskData->TrackCacheBuffer);
+            diskData->TrackCacheBufferSize = 0;
+        }
+
+        diskData->TrackCacheBuffer = ExAllocatePool(NonPagedPoolNxCacheAligned, WindowLength);
+
+        if (diskData->TrackCacheBuffer == NULL) {
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            goto FillExit;
+        }
+
+        diskData->TrackCacheBufferSize = WindowLength;
+    }
+
+    srb = ExAllocatePool(NonPagedPoolNx, SCSI_REQUEST_BLOCK_SIZE);
+
+    if (srb == NULL) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto FillExit;
+    }
+
+    //
+    // Honor the adapter's transfer limits.
+    //
+
+    maxTransfer = WindowLength;
+
+    if (adapterDescriptor != NULL) {
+
+        if (adapterDescriptor->MaximumTransferLength < maxTransfer) {
+            maxTransfer = adapterDescriptor->MaximumTransferLength;
+        }
+
+        if ((adapterDescriptor->MaximumPhysicalPages > 1) &&
+            ((adapterDescriptor->MaximumPhysicalPages - 1) * PAGE_SIZE < maxTransfer)) {
+            maxTransfer = (adapterDescriptor->MaximumPhysicalPages - 1) * PAGE_SIZE;
+        }
+    }
+
+    maxTransfer &= ~(bytesPerSector - 1);
+
+    if (maxTransfer == 0) {
+        maxTransfer = bytesPerSector;
+    }
+
+    for (done = 0; done < fillLength; done += transfer) {
+
+        transfer = min(maxTransfer, fillLength - done);
+        lba = (ULONG)((WindowOffset + done) / bytesPerSector);
+        blocks = transfer / bytesPerSector;
+
+        RtlZeroMemory(srb, SCSI_REQUEST_BLOCK_SIZE);
+
+        srb->CdbLength = 10;
+        cdb = (PCDB)srb->Cdb;
+        cdb->CDB10.OperationCode = SCSIOP_READ;
+        cdb->CDB10.LogicalBlockByte0 = (UCHAR)(lba >> 24);
+        cdb->CDB10.LogicalBlockByte1 = (UCHAR)(lba >> 16);
+        cdb->CDB10.LogicalBlockByte2 = (UCHAR)(lba >> 8);
+        cdb->CDB10.LogicalBlockByte3 = (UCHAR)lba;
+        cdb->CDB10.TransferBlocksMsb = (UCHAR)(blocks >> 8);
+        cdb->CDB10.TransferBlocksLsb = (UCHAR)blocks;
+
+        srb->TimeOutValue = fdoExtension->TimeOutValue;
+
+        status = ClassSendSrbSynchronous(DeviceObject,
+                                         srb,
+                                         diskData->TrackCacheBuffer + done,
+                                         transfer,
+                                         FALSE);
+
+        if (!NT_SUCCESS(status)) {
+            break;
+        }
+    }
+
+    ExFreePool(srb);
+
+    if (NT_SUCCESS(status)) {
+
+        //
+        // Only publish the window if nothing invalidated the cache while it
+        // was being read.
+        //
+
+        KeAcquireSpinLock(&diskData->TrackCacheLock, &oldIrql);
+
+        if ((generation == diskData->TrackCacheGeneration) &&
+            (mediaChangeCount == fdoExtension->MediaChangeCount)) {
+
+            diskData->TrackCacheOffset = WindowOffset;
+            diskData->TrackCacheLength = fillLength;
+            diskData->TrackCacheMediaChangeCount = mediaChangeCount;
+            diskData->TrackCacheValid = TRUE;
+
+        } else {
+
+            status = STATUS_UNSUCCESSFUL;
+        }
+
+        KeReleaseSpinLock(&diskData->TrackCacheLock, oldIrql);
+    }
+
+FillExit:
+
+    InterlockedExchange(&diskData->TrackCacheFilling, 0);
+
     return status;
 }
 
@@ -1380,6 +1820,8 @@ Return Value:
 
     case IOCTL_DISK_FORMAT_TRACKS: {
 
+        FlTrackCacheInvalidate(DeviceObject);
+
         if (fdoExtension->AdapterDescriptor->BusType == BusTypeUsb)
         {
             status = USBFlopFormatTracks(DeviceObject,
@@ -1503,6 +1945,16 @@ Return Value:
 
         DebugPrint((3,"ScsiIoDeviceControl: Unsupported device IOCTL\n"));
 
+        //
+        // Pass-through requests may write to the media.
+        //
+
+        if ((irpStack->Parameters.DeviceIoControl.IoControlCode == IOCTL_SCSI_PASS_THROUGH) ||
+            (irpStack->Parameters.DeviceIoControl.IoControlCode == IOCTL_SCSI_PASS_THROUGH_DIRECT)) {
+
+            FlTrackCacheInvalidate(DeviceObject);
+        }
+
         //
         // Free the Srb, since it is not needed.
         //
@@ -1692,6 +2144,12 @@ Return Value:
 
     geometry = &(fdoExtension->DiskGeometry);
 
+    //
+    // The media may have changed, so drop any cached tracks.
+    //
+
+    FlTrackCacheInvalidate(DeviceObject);
+
     //
     // Issue ReadCapacity to update device extension
     // with information for current media.
@@ -2762,6 +3220,12 @@ Return Value:
         }
 
         ClassDeleteSrbLookasideList(&deviceExtension->CommonExtension);
+
+        if(diskData->TrackCacheBuffer) {
+            ExFreePool(diskData->TrackCacheBuffer);
+            diskData->TrackCacheBuffer = NULL;
+            diskData->TrackCacheBufferSize = 0;
+        }
     }
 
     if(diskData->FloppyInterfaceString.Buffer != NULL) {
@@ -29,6 +29,14 @@ Revision History:
 
 ULONG SimSensorDebug = SIMSENSOR_PRINT_ALWAYS;
 
+//
+// All simulated zones handled by the driver, for the bulk temperature read.
+//
+
+LIST_ENTRY SimSensorZoneList;
+WDFWAITLOCK SimSensorZoneListLock;
+ULONG SimSensorNextZoneId;
+
 #define VIRTUAL_SENSOR_RESET_TEMPERATURE 42
 
 // {FCB15302-14A9-4bf8-8A0B-888E0D33BEDE}
@@ -40,6 +48,7 @@ DEFINE_GUID(GUID_VIRTUAL_TEMPERATURE_SENSOR,
 DRIVER_INITIALIZE DriverEntry;
 
 EVT_WDF_DRIVER_DEVICE_ADD           SimSensorDriverDeviceAdd;
+EVT_WDF_OBJECT_CONTEXT_CLEANUP      SimSensorDeviceCleanup;
 
 
 EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL  SimSensorIoDeviceControl;
@@ -58,6 +67,12 @@ SimSensorAddReadRequest (
     _In_ WDFREQUEST ReadRequest
     );
 
+_IRQL_requires_(PASSIVE_LEVEL)
+VOID
+SimSensorReadAllTemperatures (
+    _In_ WDFREQUEST Request
+    );
+
 _IRQL_requires_(PASSIVE_LEVEL)
 NTSTATUS
 SimSensorScanPendingQueue (
@@ -71,6 +86,7 @@ SimSensorCheckQueuedRequest (
     _In_ ULONG Temperature,
     _Inout_ PULONG LowerBound,
     _Inout_ PULONG UpperBound,
+    _Inout_ PLARGE_INTEGER NextExpiration,
     _In_ WDFREQUEST Request
     );
 
@@ -118,9 +134,11 @@ POWER_SETTING_CALLBACK SimSensorSettingCallback;
 #pragma alloc_text(PAGE, SimSensorAddReadRequest)
 #pragma alloc_text(PAGE, SimSensorAreConstraintsSatisfied)
 #pragma alloc_text(PAGE, SimSensorCheckQueuedRequest)
+#pragma alloc_text(PAGE, SimSensorDeviceCleanup)
 #pragma alloc_text(PAGE, SimSensorSelfManagedIoSuspend)
 #pragma alloc_text(PAGE, SimSensorDriverDeviceAdd)
 #pragma alloc_text(PAGE, SimSensorExpiredRequestTimer)
+#pragma alloc_text(PAGE, SimSensorReadAllTemperatures)
 #pragma alloc_text(PAGE, SimSensorScanPendingQueue)
 #pragma alloc_text(PAGE, SimSensorIoDeviceControl)
 
@@ -190,6 +208,20 @@ Return Value:
         goto DriverEntryEnd;
     }
 
+    //
+    // Create the zone list lock. It is parented to the driver object.
+    //
+
+    InitializeListHead(&SimSensorZoneList);
+    Status = WdfWaitLockCreate(WDF_NO_OBJECT_ATTRIBUTES, &SimSensorZoneListLock);
+    if (!NT_SUCCESS(Status)) {
+        DebugPrint(SIMSENSOR_ERROR,
+                   "WdfWaitLockCreate() Failed. Status 0x%x\n",
+                   Status);
+
+        goto DriverEntryEnd;
+    }
+
 DriverEntryEnd:
     DebugExitStatus(Status);
     return Status;
@@ -233,6 +265,8 @@ Return Value:
     WDFQUEUE Queue;
     WDF_IO_QUEUE_CONFIG QueueConfig;
     NTSTATUS Status;
+    WDF_OBJECT_ATTRIBUTES TimerAttributes;
+    WDF_TIMER_CONFIG TimerConfig;
     WDF_OBJECT_ATTRIBUTES WorkitemAttributes;
     WDF_WORKITEM_CONFIG WorkitemConfig;
 
@@ -249,6 +283,7 @@ Return Value:
 
     WDF_OBJECT_ATTRIBUTES_INIT(&DeviceAttributes);
     WDF_OBJECT_ATTRIBUTES_SET_CONTEXT_TYPE(&DeviceAttributes, FDO_DATA);
+    DeviceAttributes.EvtCleanupCallback = SimSensorDeviceCleanup;
 
     //
     // Initailize power callbacks
@@ -278,6 +313,7 @@ Return Value:
     }
 
     DevExt = GetDeviceExtension(DeviceHandle);
+    InitializeListHead(&DevExt->ZoneListEntry);
 
     //
     // Configure a default queue for IO requests. This queue processes requests
@@ -385,12 +421,91 @@ Return Value:
         goto DriverDeviceAddEnd;
     }
 
+    //
+    // Create the timer that completes expired read requests.
+    //
+
+    WDF_TIMER_CONFIG_INIT(&TimerConfig, SimSensorExpiredRequestTimer);
+    WDF_OBJECT_ATTRIBUTES_INIT(&TimerAttributes);
+    TimerAttributes.ExecutionLevel = WdfExecutionLevelPassive;
+    TimerAttributes.SynchronizationScope = WdfSynchronizationScopeNone;
+    TimerAttributes.ParentObject = DeviceHandle;
+    Status = WdfTimerCreate(&TimerConfig,
+                            &TimerAttributes,
+                            &DevExt->ExpirationTimer);
+
+    if (!NT_SUCCESS(Status)) {
+        DebugPrint(SIMSENSOR_ERROR,
+                   "WdfTimerCreate() Failed. 0x%x\n",
+                   Status);
+
+        goto DriverDeviceAddEnd;
+    }
+
+    //
+    // Expose an interface for clients of the bulk temperature read.
+    //
+
+    Status = WdfDeviceCreateDeviceInterface(DeviceHandle,
+                                            &GUID_DEVICE_INTERFACE_SIMSENSOR,
+                                            NULL);
+
+    if (!NT_SUCCESS(Status)) {
+        DebugPrint(SIMSENSOR_ERROR,
+                   "WdfDeviceCreateDeviceInterface() Failed. 0x%x\n",
+                   Status);
+
+        goto DriverDeviceAddEnd;
+    }
+
+    WdfWaitLockAcquire(SimSensorZoneListLock, NULL);
+    DevExt->ZoneId = SimSensorNextZoneId;
+    SimSensorNextZoneId += 1;
+    InsertTailList(&SimSensorZoneList, &DevExt->ZoneListEntry);
+    WdfWaitLockRelease(SimSensorZoneListLock);
+
 DriverDeviceAddEnd:
 
     DebugExitStatus(Status);
     return Status;
 }
 
+VOID
+SimSensorDeviceCleanup (
+    WDFOBJECT Object
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is invoked when the device object is being deleted, and
+    removes the device from the list of simulated zones.
+
+Arguments:
+
+    Object - Supplies a handle to the device.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PFDO_DATA DevExt;
+
+    PAGED_CODE();
+
+    DevExt = GetDeviceExtension((WDFDEVICE)Object);
+    WdfWaitLockAcquire(SimSensorZoneListLock, NULL);
+    RemoveEntryList(&DevExt->ZoneListEntry);
+    InitializeListHead(&DevExt->ZoneListEntry);
+    WdfWaitLockRelease(SimSensorZoneListLock);
+    return;
+}
+
 VOID
 SimSensorQueueIoStop (
     _In_ WDFQUEUE Queue,
@@ -505,6 +620,11 @@ Return Value:
 
         SimSensorAddReadRequest(Device, Request);
         break;
+
+    case IOCTL_SIMSENSOR_READ_ALL_TEMPERATURES:
+        SimSensorReadAllTemperatures(Request);
+        break;
+
     default:
 
         //
@@ -685,9 +805,6 @@ Arguments:
     PULONG RequestTemperature;
     NTSTATUS Status;
     ULONG Temperature;
-    WDFTIMER Timer;
-    WDF_OBJECT_ATTRIBUTES TimerAttributes;
-    WDF_TIMER_CONFIG TimerConfig;
     PTHERMAL_WAIT_READ ThermalWaitRead;
 
 
@@ -790,38 +907,6 @@ Arguments:
         Context->ExpirationTime.QuadPart = ExpirationTime.QuadPart;
         Context->LowTemperature = ThermalWaitRead->LowTemperature;
         Context->HighTemperature = ThermalWaitRead->HighTemperature;
-        if(Context->ExpirationTime.QuadPart != -1LL /* INFINITE */ ) {
-
-            //
-            // This request eventually expires, create a timer to complete it.
-            //
-
-            WDF_TIMER_CONFIG_INIT(&TimerConfig, SimSensorExpiredRequestTimer);
-            WDF_OBJECT_ATTRIBUTES_INIT(&TimerAttributes);
-            TimerAttributes.ExecutionLevel = WdfExecutionLevelPassive;
-            TimerAttributes.SynchronizationScope = WdfSynchronizationScopeNone;
-            TimerAttributes.ParentObject = Device;
-            Status = WdfTimerCreate(&TimerConfig,
-                                    &TimerAttributes,
-                                    &Timer);
-
-            if(!NT_SUCCESS(Status)) {
-                DebugPrint(SIMSENSOR_ERROR,
-                        "WdfTimerCreate() Failed. 0x%x",
-                        Status);
-
-                WdfRequestCompleteWithInformation(ReadRequest,
-                                                  Status,
-                                                  BytesReturned);
-
-                goto AddReadRequestEnd;
-            }
-
-            WdfTimerStart(Timer,
-                          WDF_REL_TIMEOUT_IN_MS(ThermalWaitRead->Timeout));
-
-        }
-
         Status = WdfRequestForwardToIoQueue(ReadRequest,
                                             DevExt->PendingRequestQueue);
 
@@ -838,7 +923,8 @@ Arguments:
         }
 
         //
-        // Force a rescan of the queue to update the interrupt thresholds.
+        // Force a rescan of the queue to update the interrupt thresholds and
+        // the expiration timer.
         //
 
         SimSensorScanPendingQueue(Device);
@@ -878,6 +964,7 @@ Arguments:
     PFDO_DATA DevExt;
     WDFREQUEST LastRequest;
     ULONG LowerBound;
+    LARGE_INTEGER NextExpiration;
     NTSTATUS Status;
     ULONG Temperature;
     ULONG UpperBound;
@@ -900,6 +987,7 @@ Arguments:
 
     LowerBound = 0;
     UpperBound = (ULONG)-1;
+    NextExpiration.QuadPart = -1LL /* INFINITE */;
     Status = WdfIoQueueFindRequest(DevExt->PendingRequestQueue,
                                    NULL,
                                    NULL,
@@ -937,6 +1025,7 @@ Arguments:
                                     Temperature,
                                     &LowerBound,
                                     &UpperBound,
+                                    &NextExpiration,
                                     LastRequest);
 
         WdfObjectDereference(LastRequest);
@@ -949,6 +1038,7 @@ Arguments:
 
             LowerBound = 0;
             UpperBound = (ULONG)-1;
+            NextExpiration.QuadPart = -1LL /* INFINITE */;
             Status = WdfIoQueueFindRequest(DevExt->PendingRequestQueue,
                                            NULL,
                                            NULL,
@@ -964,6 +1054,19 @@ Arguments:
     //
 
     SimSensorSetVirtualInterruptThresholds(Device, LowerBound, UpperBound);
+
+    //
+    // Arm the expiration timer for the earliest request that still expires.
+    // A positive due time is an absolute system time.
+    //
+
+    if (NextExpiration.QuadPart != -1LL /* INFINITE */ ) {
+        WdfTimerStart(DevExt->ExpirationTimer, NextExpiration.QuadPart);
+
+    } else {
+        WdfTimerStop(DevExt->ExpirationTimer, FALSE);
+    }
+
     DebugExitStatus(Status);
     return Status;
 }
@@ -1005,6 +1108,7 @@ SimSensorCheckQueuedRequest (
     _In_ ULONG Temperature,
     _Inout_ PULONG LowerBound,
     _Inout_ PULONG UpperBound,
+    _Inout_ PLARGE_INTEGER NextExpiration,
     _In_ WDFREQUEST Request
     )
 
@@ -1019,7 +1123,8 @@ Routine Description:
 
     * Retires the request if it is expired (the timer due time is in the past)
 
-    * Tightens the upper and lower bounds if the request remains in the queue.
+    * Tightens the upper and lower bounds and the next expiration time if the
+      request remains in the queue.
 
 Arguments:
 
@@ -1031,6 +1136,8 @@ Arguments:
 
     UpperBound - Supplies the upper bound threshold to adjust.
 
+    NextExpiration - Supplies the earliest expiration time to adjust.
+
     Request - Supplies a handle to the request.
 
 --*/
@@ -1123,6 +1230,13 @@ Arguments:
         if (*UpperBound > Context->HighTemperature) {
             *UpperBound = Context->HighTemperature;
         }
+
+        if ((Context->ExpirationTime.QuadPart != -1LL /* INFINITE */ ) &&
+            ((NextExpiration->QuadPart == -1LL /* INFINITE */ ) ||
+             (NextExpiration->QuadPart > Context->ExpirationTime.QuadPart))) {
+
+            NextExpiration->QuadPart = Context->ExpirationTime.QuadPart;
+        }
     }
 
 CheckQueuedRequestEnd:
@@ -1130,6 +1244,93 @@ CheckQueuedRequestEnd:
     return;
 }
 
+_IRQL_requires_(PASSIVE_LEVEL)
+VOID
+SimSensorReadAllTemperatures (
+    _In_ WDFREQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    Handles IOCTL_SIMSENSOR_READ_ALL_TEMPERATURES by returning the current
+    temperature of every simulated zone in one request. If the output buffer
+    is too small for all of them, as many as fit are returned along with the
+    total zone count and STATUS_BUFFER_OVERFLOW.
+
+Arguments:
+
+    Request - Supplies a handle to the request.
+
+--*/
+
+{
+    PSIMSENSOR_ALL_TEMPERATURES AllTemperatures;
+    size_t BytesReturned;
+    ULONG Capacity;
+    PFDO_DATA DevExt;
+    PLIST_ENTRY Entry;
+    size_t Length;
+    NTSTATUS Status;
+    PSIMSENSOR_ZONE_TEMPERATURE Zone;
+
+    DebugEnter();
+    PAGED_CODE();
+
+    BytesReturned = 0;
+    Status = WdfRequestRetrieveOutputBuffer(
+                Request,
+                FIELD_OFFSET(SIMSENSOR_ALL_TEMPERATURES, Zones),
+                &AllTemperatures,
+                &Length);
+
+    if (!NT_SUCCESS(Status)) {
+        DebugPrint(SIMSENSOR_ERROR,
+                   "WdfRequestRetrieveOutputBuffer() Failed. 0x%x",
+                   Status);
+
+        goto ReadAllTemperaturesEnd;
+    }
+
+    Capacity = (ULONG)((Length - FIELD_OFFSET(SIMSENSOR_ALL_TEMPERATURES, Zones)) /
+                       sizeof(SIMSENSOR_ZONE_TEMPERATURE));
+
+    AllTemperatures->ZoneCount = 0;
+    AllTemperatures->ReturnedCount = 0;
+    WdfWaitLockAcquire(SimSensorZoneListLock, NULL);
+    for (Entry = SimSensorZoneList.Flink;
+         Entry != &SimSensorZoneList;
+         Entry = Entry->Flink) {
+
+        DevExt = CONTAINING_RECORD(Entry, FDO_DATA, ZoneListEntry);
+        if (AllTemperatures->ReturnedCount < Capacity) {
+            Zone = &AllTemperatures->Zones[AllTemperatures->ReturnedCount];
+            Zone->ZoneId = DevExt->ZoneId;
+            Zone->Temperature = SimSensorReadVirtualTemperature(
+                                    (WDFDEVICE)WdfObjectContextGetObject(DevExt));
+
+            AllTemperatures->ReturnedCount += 1;
+        }
+
+        AllTemperatures->ZoneCount += 1;
+    }
+
+    WdfWaitLockRelease(SimSensorZoneListLock);
+
+    BytesReturned = FIELD_OFFSET(SIMSENSOR_ALL_TEMPERATURES, Zones) +
+                    (AllTemperatures->ReturnedCount *
+                     sizeof(SIMSENSOR_ZONE_TEMPERATURE));
+
+    if (AllTemperatures->ReturnedCount < AllTemperatures->ZoneCount) {
+        Status = STATUS_BUFFER_OVERFLOW;
+    }
+
+ReadAllTemperaturesEnd:
+    WdfRequestCompleteWithInformation(Request, Status, BytesReturned);
+    DebugExitStatus(Status);
+}
+
 VOID
 SimSensorExpiredRequestTimer (
     WDFTIMER Timer
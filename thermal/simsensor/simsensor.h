@@ -69,11 +69,50 @@ Revision History:
 
 //----------------------------------------------------------------- Definitions
 
+//
+// A client opens any instance of GUID_DEVICE_INTERFACE_SIMSENSOR and sends
+// IOCTL_SIMSENSOR_READ_ALL_TEMPERATURES to read every simulated zone at once,
+// instead of polling each sensor separately. The output buffer receives a
+// SIMSENSOR_ALL_TEMPERATURES followed by the zones.
+//
+
+// {3B5B6519-3F4D-4F3E-9C86-5B8ED2B3F3A1}
+DEFINE_GUID(GUID_DEVICE_INTERFACE_SIMSENSOR,
+0x3b5b6519, 0x3f4d, 0x4f3e, 0x9c, 0x86, 0x5b, 0x8e, 0xd2, 0xb3, 0xf3, 0xa1);
+
+#define IOCTL_SIMSENSOR_READ_ALL_TEMPERATURES \
+    CTL_CODE(FILE_DEVICE_UNKNOWN, 0x800, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+typedef struct {
+    ULONG ZoneId;
+    ULONG Temperature;
+} SIMSENSOR_ZONE_TEMPERATURE, *PSIMSENSOR_ZONE_TEMPERATURE;
+
+typedef struct {
+    ULONG ZoneCount;        // Number of simulated zones present.
+    ULONG ReturnedCount;    // Number of entries that fit in the buffer.
+    SIMSENSOR_ZONE_TEMPERATURE Zones[ANYSIZE_ARRAY];
+} SIMSENSOR_ALL_TEMPERATURES, *PSIMSENSOR_ALL_TEMPERATURES;
+
 typedef struct {
     WDFQUEUE    PendingRequestQueue;
     WDFWAITLOCK QueueLock;
     WDFWORKITEM InterruptWorker;
 
+    //
+    // A single timer completes expired read requests. Every scan of the
+    // pending queue re-arms it for the earliest expiration still queued.
+    //
+
+    WDFTIMER    ExpirationTimer;
+
+    //
+    // Entry in the driver-wide list of simulated zones.
+    //
+
+    LIST_ENTRY  ZoneListEntry;
+    ULONG       ZoneId;
+
     //
     // Virtual temperature sensor internal state. This portion of the context
     // should be opaque to most of the driver, except the portion implementing
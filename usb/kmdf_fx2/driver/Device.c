@@ -78,6 +78,8 @@ Return Value:
     UNICODE_STRING                      symbolicLinkName;
     WDFSTRING                           symbolicLinkString;
     DEVPROP_BOOLEAN                     isRestricted;
+    ULONG                               bulkReadRing = 0;
+    WDF_FILEOBJECT_CONFIG               fileConfig;
 
     UNREFERENCED_PARAMETER(Driver);
 
@@ -113,6 +115,22 @@ Return Value:
 
     WdfDeviceInitSetIoType(DeviceInit, WdfDeviceIoBuffered);
 
+    //
+    // The INF sets BulkReadRing to 1 to serve reads from a ring filled by
+    // a continuous reader, instead of sending each read to the device.
+    //
+    OsrFxReadFdoRegistryKeyValue(DeviceInit, L"BulkReadRing", &bulkReadRing);
+
+    if (bulkReadRing != 0) {
+        //
+        // An application can have the ring's data put straight into a
+        // buffer of its own, for as long as it keeps a map request pending.
+        // Closing the handle ends that too.
+        //
+        WDF_FILEOBJECT_CONFIG_INIT(&fileConfig, WDF_NO_EVENT_CALLBACK, WDF_NO_EVENT_CALLBACK, OsrFxEvtFileCleanup);
+        WdfDeviceInitSetFileObjectConfig(DeviceInit, &fileConfig, WDF_NO_OBJECT_ATTRIBUTES);
+    }
+
     //
     // Now specify the size of device extension where we track per device
     // context.DeviceInit is completely initialized. So call the framework
@@ -139,6 +157,8 @@ Return Value:
     //
     pDevContext = GetDeviceContext(device);
 
+    pDevContext->BulkReadRingEnabled = (bulkReadRing != 0);
+
     //
     // Get the device's friendly name and location so that we can use it in
     // error logging.  If this fails then it will setup dummy strings.
@@ -295,6 +315,74 @@ Return Value:
         goto Error;
     }
 
+    if (pDevContext->BulkReadRingEnabled) {
+        WDFMEMORY ringMemory;
+
+        //
+        // Register a manual I/O queue where read requests wait for data from
+        // the bulk read ring. It is power managed, so that the device stays
+        // in D0, with the continuous reader running, while reads wait.
+        //
+        WDF_IO_QUEUE_CONFIG_INIT(&ioQueueConfig, WdfIoQueueDispatchManual);
+
+        status = WdfIoQueueCreate(device,
+                                  &ioQueueConfig,
+                                  WDF_NO_OBJECT_ATTRIBUTES,
+                                  &pDevContext->BulkReadRingQueue
+                                  );
+
+        if (!NT_SUCCESS(status)) {
+            TraceEvents(TRACE_LEVEL_ERROR, DBG_PNP,
+                "WdfIoQueueCreate failed 0x%x\n", status);
+            goto Error;
+        }
+
+        WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+        attributes.ParentObject = device;
+
+        status = WdfSpinLockCreate(&attributes, &pDevContext->BulkReadRingLock);
+        if (!NT_SUCCESS(status)) {
+            TraceEvents(TRACE_LEVEL_ERROR, DBG_PNP,
+                     "WdfSpinLockCreate failed  %!STATUS!\n", status);
+            goto Error;
+        }
+
+        status = WdfMemoryCreate(&attributes,
+                                 NonPagedPool,
+                                 POOL_TAG,
+                                 BULK_READ_RING_SIZE,
+                                 &ringMemory,
+                                 (PVOID*) &pDevContext->BulkReadRing);
+        if (!NT_SUCCESS(status)) {
+            TraceEvents(TRACE_LEVEL_ERROR, DBG_PNP,
+                     "WdfMemoryCreate failed  %!STATUS!\n", status);
+            goto Error;
+        }
+
+        //
+        // Register a manual I/O queue where IOCTL_OSRUSBFX2_MAP_BULK_READ_RING
+        // waits for as long as the application's buffer is in use. Like the
+        // interrupt message queue it is not power managed; cancelling the
+        // request takes the buffer back whatever the power state.
+        //
+        WDF_IO_QUEUE_CONFIG_INIT(&ioQueueConfig, WdfIoQueueDispatchManual);
+
+        ioQueueConfig.PowerManaged = WdfFalse;
+        ioQueueConfig.EvtIoCanceledOnQueue = OsrFxEvtBulkReadRingMapCanceledOnQueue;
+
+        status = WdfIoQueueCreate(device,
+                                  &ioQueueConfig,
+                                  WDF_NO_OBJECT_ATTRIBUTES,
+                                  &pDevContext->BulkReadRingMapQueue
+                                  );
+
+        if (!NT_SUCCESS(status)) {
+            TraceEvents(TRACE_LEVEL_ERROR, DBG_PNP,
+                "WdfIoQueueCreate failed 0x%x\n", status);
+            goto Error;
+        }
+    }
+
     //
     // Register a device interface so that app can find our device and talk to it.
     //
@@ -522,6 +610,10 @@ Return Value:
 
     status = OsrFxConfigContReaderForInterruptEndPoint(pDeviceContext);
 
+    if (NT_SUCCESS(status) && pDeviceContext->BulkReadRingEnabled) {
+        status = OsrFxConfigContReaderForBulkReadEndPoint(pDeviceContext);
+    }
+
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_PNP, "<-- EvtDevicePrepareHardware\n");
 
     return status;
@@ -590,6 +682,18 @@ Return Value:
 
     isTargetStarted = TRUE;
 
+    //
+    // The bulk IN pipe has a continuous reader too if reads are served from
+    // the bulk read ring.
+    //
+    if (pDeviceContext->BulkReadRingEnabled) {
+        status = WdfIoTargetStart(WdfUsbTargetPipeGetIoTarget(pDeviceContext->BulkReadPipe));
+        if (!NT_SUCCESS(status)) {
+            TraceEvents(TRACE_LEVEL_ERROR, DBG_POWER, "Failed to start bulk read pipe %!STATUS!\n", status);
+            goto End;
+        }
+    }
+
 End:
 
     if (!NT_SUCCESS(status)) {
@@ -663,6 +767,10 @@ Return Value:
 
     WdfIoTargetStop(WdfUsbTargetPipeGetIoTarget(pDeviceContext->InterruptPipe),   WdfIoTargetCancelSentIo);
 
+    if (pDeviceContext->BulkReadRingEnabled) {
+        WdfIoTargetStop(WdfUsbTargetPipeGetIoTarget(pDeviceContext->BulkReadPipe), WdfIoTargetCancelSentIo);
+    }
+
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_POWER, "<--OsrFxEvtDeviceD0Exit\n");
 
     return STATUS_SUCCESS;
@@ -692,6 +800,11 @@ Return Value:
     // Service the interrupt message queue to drain any outstanding
     // requests
     OsrUsbIoctlGetInterruptMessage(Device, STATUS_DEVICE_REMOVED);
+
+    // Same for the reads waiting on the bulk read ring
+    if (GetDeviceContext(Device)->BulkReadRingEnabled) {
+        OsrFxServiceBulkReadRing(Device, STATUS_DEVICE_REMOVED);
+    }
 }
 
 _IRQL_requires_(PASSIVE_LEVEL)
@@ -752,6 +865,67 @@ Return Value:
 }
 
 
+_IRQL_requires_(PASSIVE_LEVEL)
+BOOLEAN
+OsrFxReadFdoRegistryKeyValue(
+    _In_ PWDFDEVICE_INIT  DeviceInit,
+    _In_ PWCHAR           Name,
+    _Out_ PULONG          Value
+    )
+/*++
+
+Routine Description:
+
+    Can be used to read any REG_DWORD registry value stored
+    under Device Parameter.
+
+Arguments:
+
+    DeviceInit - Pointer to the WDFDEVICE_INIT structure of the device
+
+    Name - Name of the registry value
+
+    Value - Receives the value, or 0 if it couldn't be read
+
+Return Value:
+
+    TRUE if the value was read
+
+--*/
+{
+    WDFKEY      hKey = NULL;
+    NTSTATUS    status;
+    BOOLEAN     retValue = FALSE;
+    UNICODE_STRING  valueName;
+
+    PAGED_CODE();
+
+    *Value = 0;
+
+    status = WdfFdoInitOpenRegistryKey(DeviceInit,
+                                       PLUGPLAY_REGKEY_DEVICE,
+                                       STANDARD_RIGHTS_ALL,
+                                       WDF_NO_OBJECT_ATTRIBUTES,
+                                       &hKey);
+
+    if (NT_SUCCESS (status)) {
+
+        RtlInitUnicodeString(&valueName,Name);
+
+        status = WdfRegistryQueryULong (hKey,
+                                  &valueName,
+                                  Value);
+
+        if (NT_SUCCESS (status)) {
+            retValue = TRUE;
+        }
+
+        WdfRegistryClose(hKey);
+    }
+
+    return retValue;
+}
+
 _IRQL_requires_(PASSIVE_LEVEL)
 NTSTATUS
 OsrFxSetPowerPolicy(
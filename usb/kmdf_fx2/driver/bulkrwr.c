@@ -31,6 +31,12 @@ Environment:
 
 #pragma warning(disable:4267)
 
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, OsrFxMapBulkReadRing)
+#pragma alloc_text(PAGE, OsrFxUnmapBulkReadRing)
+#pragma alloc_text(PAGE, OsrFxEvtFileCleanup)
+#endif
+
 VOID
 OsrFxEvtIoRead(
     _In_ WDFQUEUE         Queue,
@@ -87,6 +93,24 @@ Return Value:
 
     pDeviceContext = GetDeviceContext(WdfIoQueueGetDevice(Queue));
 
+    //
+    // If the continuous reader fills the bulk read ring, park the request
+    // in the ring queue and serve it from whatever the ring already holds.
+    // The read queue is sequential and the ring queue is FIFO, so reads
+    // are served in the order they arrive.
+    //
+    if (pDeviceContext->BulkReadRingEnabled) {
+        status = WdfRequestForwardToIoQueue(Request, pDeviceContext->BulkReadRingQueue);
+        if (!NT_SUCCESS(status)) {
+            TraceEvents(TRACE_LEVEL_ERROR, DBG_READ,
+                   "WdfRequestForwardToIoQueue failed %!STATUS!\n", status);
+            goto Exit;
+        }
+
+        OsrFxServiceBulkReadRing(WdfIoQueueGetDevice(Queue), STATUS_SUCCESS);
+        goto Exit;
+    }
+
     pipe = pDeviceContext->BulkReadPipe;
 
     status = WdfRequestRetrieveOutputMemory(Request, &reqMemory);
@@ -211,6 +235,555 @@ Return Value:
     return;
 }
 
+_IRQL_requires_(PASSIVE_LEVEL)
+NTSTATUS
+OsrFxConfigContReaderForBulkReadEndPoint(
+    _In_ PDEVICE_CONTEXT DeviceContext
+    )
+/*++
+
+Routine Description:
+
+    This routine configures a continuous reader on the bulk IN
+    endpoint, which keeps the bulk read ring filled. It's called
+    from the PrepareHarware event when the BulkReadRing registry
+    value is set. The reader is started in D0Entry.
+
+Arguments:
+
+    DeviceContext - Device context of the device
+
+Return Value:
+
+    NT status value
+
+--*/
+{
+    WDF_USB_CONTINUOUS_READER_CONFIG contReaderConfig;
+    NTSTATUS status;
+
+    WDF_USB_CONTINUOUS_READER_CONFIG_INIT(&contReaderConfig,
+                                          OsrFxEvtUsbBulkPipeReadComplete,
+                                          DeviceContext,    // Context
+                                          BULK_READ_RING_TRANSFER_SIZE);
+
+    contReaderConfig.EvtUsbTargetPipeReadersFailed = OsrFxEvtUsbBulkReadersFailed;
+
+    //
+    // Keep more than the default two reads pending, so that the device
+    // always has a buffer to fill while completed ones are copied.
+    //
+    contReaderConfig.NumPendingReads = BULK_READ_RING_READERS;
+
+    status = WdfUsbTargetPipeConfigContinuousReader(DeviceContext->BulkReadPipe,
+                                                    &contReaderConfig);
+
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_PNP,
+                    "OsrFxConfigContReaderForBulkReadEndPoint failed %x\n",
+                    status);
+        return status;
+    }
+
+    return status;
+}
+
+VOID
+OsrFxEvtUsbBulkPipeReadComplete(
+    WDFUSBPIPE  Pipe,
+    WDFMEMORY   Buffer,
+    size_t      NumBytesTransferred,
+    WDFCONTEXT  Context
+    )
+/*++
+
+Routine Description:
+
+    This the completion routine of the bulk IN continuous reader. It
+    appends the data to the bulk read ring and serves waiting reads.
+    It can be called concurrently, since more than one reader is
+    configured, so the ring is only touched under its lock.
+
+    When the ring is full, the new data is dropped and counted,
+    since nobody is reading it.
+
+Arguments:
+
+    Buffer - This buffer is freed when this call returns.
+
+    Context - Provided in the WDF_USB_CONTINUOUS_READER_CONFIG_INIT macro
+
+Return Value:
+
+    None
+
+--*/
+{
+    PDEVICE_CONTEXT pDeviceContext = Context;
+    PUCHAR          data;
+    ULONG           length = (ULONG) NumBytesTransferred;
+    ULONG           copied;
+    ULONG           tail;
+    ULONG           chunk;
+
+    UNREFERENCED_PARAMETER(Pipe);
+
+    if (length == 0) {
+        return;
+    }
+
+    data = WdfMemoryGetBuffer(Buffer, NULL);
+
+    WdfSpinLockAcquire(pDeviceContext->BulkReadRingLock);
+
+    if (pDeviceContext->BulkReadRingMapRequest != NULL) {
+
+        ULONG size = pDeviceContext->BulkReadRingMapSize;
+
+        //
+        // The application consumes the data from the buffer of its map
+        // request and is never waited for, so the new data always goes in,
+        // over the oldest. The buffer holds at least one transfer.
+        //
+        NT_ASSERT(length <= size);
+
+        tail = (ULONG) (pDeviceContext->BulkReadRingWritten % size);
+
+        chunk = min(length, size - tail);
+
+        RtlCopyMemory(pDeviceContext->BulkReadRingMapData + tail, data, chunk);
+        RtlCopyMemory(pDeviceContext->BulkReadRingMapData, data + chunk, length - chunk);
+
+        //
+        // Publish the new count only once the data is in the buffer.
+        //
+        pDeviceContext->BulkReadRingWritten += length;
+        InterlockedExchange64(&pDeviceContext->BulkReadRingMapHeader->BytesWritten,
+                              pDeviceContext->BulkReadRingWritten);
+
+        WdfSpinLockRelease(pDeviceContext->BulkReadRingLock);
+        return;
+    }
+
+    copied = min(length, BULK_READ_RING_SIZE - pDeviceContext->BulkReadRingCount);
+
+    tail = (pDeviceContext->BulkReadRingHead + pDeviceContext->BulkReadRingCount) %
+           BULK_READ_RING_SIZE;
+
+    chunk = min(copied, BULK_READ_RING_SIZE - tail);
+
+    RtlCopyMemory(pDeviceContext->BulkReadRing + tail, data, chunk);
+    RtlCopyMemory(pDeviceContext->BulkReadRing, data + chunk, copied - chunk);
+
+    pDeviceContext->BulkReadRingCount += copied;
+    pDeviceContext->BulkReadRingDropped += length - copied;
+
+    WdfSpinLockRelease(pDeviceContext->BulkReadRingLock);
+
+    if (copied < length) {
+        TraceEvents(TRACE_LEVEL_WARNING, DBG_READ,
+                    "Bulk read ring full, dropped %d bytes (%d total)\n",
+                    length - copied, pDeviceContext->BulkReadRingDropped);
+    }
+
+    OsrFxServiceBulkReadRing(WdfObjectContextGetObject(pDeviceContext), STATUS_SUCCESS);
+}
+
+BOOLEAN
+OsrFxEvtUsbBulkReadersFailed(
+    _In_ WDFUSBPIPE Pipe,
+    _In_ NTSTATUS Status,
+    _In_ USBD_STATUS UsbdStatus
+    )
+/*++
+
+Routine Description:
+
+    Called by the framework when a bulk continuous reader fails. The
+    reads waiting on the ring are failed with the reader's status;
+    returning TRUE lets the framework reset the pipe and restart
+    the readers.
+
+--*/
+{
+    WDFDEVICE device = WdfIoTargetGetDevice(WdfUsbTargetPipeGetIoTarget(Pipe));
+
+    TraceEvents(TRACE_LEVEL_ERROR, DBG_READ,
+                "Bulk continuous reader failed - status %!STATUS! UsbdStatus 0x%x\n",
+                Status, UsbdStatus);
+
+    OsrFxServiceBulkReadRing(device, Status);
+
+    return TRUE;
+}
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+OsrFxServiceBulkReadRing(
+    _In_ WDFDEVICE Device,
+    _In_ NTSTATUS  ReaderStatus
+    )
+/*++
+
+Routine Description:
+
+    Completes the reads waiting in the bulk read ring queue, oldest
+    first, with the data the ring holds. A read gets whatever is
+    available up to its length, so a read only waits while the ring
+    is empty.
+
+    If ReaderStatus is a failure, the reads left waiting once the ring
+    is empty are completed with it.
+
+Arguments:
+
+    Device - Handle to a framework device
+
+    ReaderStatus - STATUS_SUCCESS to only serve the data in the ring,
+                   or the status to fail the remaining reads with
+
+Return Value:
+
+    None
+
+--*/
+{
+    PDEVICE_CONTEXT pDeviceContext = GetDeviceContext(Device);
+    WDFREQUEST      request;
+    WDFMEMORY       reqMemory;
+    NTSTATUS        status;
+    size_t          length;
+    ULONG           bytesRead;
+    ULONG           chunk;
+    GUID            activity;
+
+    for (;;) {
+
+        bytesRead = 0;
+
+        WdfSpinLockAcquire(pDeviceContext->BulkReadRingLock);
+
+        if (pDeviceContext->BulkReadRingCount == 0 && NT_SUCCESS(ReaderStatus) &&
+            pDeviceContext->BulkReadRingMapRequest == NULL) {
+            WdfSpinLockRelease(pDeviceContext->BulkReadRingLock);
+            break;
+        }
+
+        status = WdfIoQueueRetrieveNextRequest(pDeviceContext->BulkReadRingQueue, &request);
+        if (!NT_SUCCESS(status)) {
+            WdfSpinLockRelease(pDeviceContext->BulkReadRingLock);
+            break;
+        }
+
+        if (pDeviceContext->BulkReadRingMapRequest != NULL) {
+
+            //
+            // The data goes to the application's map request.
+            //
+            status = STATUS_DEVICE_BUSY;
+
+        } else {
+
+            status = WdfRequestRetrieveOutputMemory(request, &reqMemory);
+        }
+
+        if (NT_SUCCESS(status) && pDeviceContext->BulkReadRingCount != 0) {
+            PUCHAR buffer = WdfMemoryGetBuffer(reqMemory, &length);
+
+            bytesRead = (ULONG) min(length, pDeviceContext->BulkReadRingCount);
+
+            chunk = min(bytesRead, BULK_READ_RING_SIZE - pDeviceContext->BulkReadRingHead);
+
+            RtlCopyMemory(buffer,
+                          pDeviceContext->BulkReadRing + pDeviceContext->BulkReadRingHead,
+                          chunk);
+            RtlCopyMemory(buffer + chunk, pDeviceContext->BulkReadRing, bytesRead - chunk);
+
+            pDeviceContext->BulkReadRingHead = (pDeviceContext->BulkReadRingHead + bytesRead) %
+                                               BULK_READ_RING_SIZE;
+            pDeviceContext->BulkReadRingCount -= bytesRead;
+
+        } else if (NT_SUCCESS(status)) {
+            status = ReaderStatus;
+        }
+
+        WdfSpinLockRelease(pDeviceContext->BulkReadRingLock);
+
+        if (NT_SUCCESS(status)) {
+            TraceEvents(TRACE_LEVEL_INFORMATION, DBG_READ,
+                        "Number of bytes read from ring: %d\n", bytesRead);
+        } else {
+            TraceEvents(TRACE_LEVEL_ERROR, DBG_READ,
+                        "Ring read failed - request status %!STATUS!\n", status);
+        }
+
+        activity = RequestToActivityId(request);
+
+        EventWriteReadStop(&activity,
+                           Device,
+                           bytesRead,
+                           status,
+                           USBD_STATUS_SUCCESS);
+
+        WdfRequestCompleteWithInformation(request, status, bytesRead);
+    }
+
+    return;
+}
+
+VOID
+OsrFxEvtFileCleanup(
+    _In_ WDFFILEOBJECT FileObject
+    )
+/*++
+
+Routine Description:
+
+    Called when the last handle to a file object is closed. A map
+    request sent on it must not outlive the handle, so it is completed
+    here.
+
+Arguments:
+
+    FileObject - Handle to the framework file object
+
+Return Value:
+
+    None
+
+--*/
+{
+    PAGED_CODE();
+
+    (VOID) OsrFxUnmapBulkReadRing(WdfFileObjectGetDevice(FileObject), FileObject);
+}
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+BOOLEAN
+OsrFxDetachBulkReadRing(
+    _In_ PDEVICE_CONTEXT pDeviceContext,
+    _In_ WDFREQUEST      Request
+    )
+/*++
+
+Routine Description:
+
+    Stops putting the ring's data into the buffer of Request, if it is
+    the map request, and goes back to serving read requests. Once this
+    returns the continuous reader no longer touches the buffer, so the
+    request can be completed.
+
+Return Value:
+
+    TRUE if Request was the map request.
+
+--*/
+{
+    BOOLEAN detached = FALSE;
+
+    WdfSpinLockAcquire(pDeviceContext->BulkReadRingLock);
+
+    if (pDeviceContext->BulkReadRingMapRequest == Request) {
+        pDeviceContext->BulkReadRingMapRequest = NULL;
+        pDeviceContext->BulkReadRingMapHeader = NULL;
+        pDeviceContext->BulkReadRingMapData = NULL;
+        pDeviceContext->BulkReadRingMapSize = 0;
+        pDeviceContext->BulkReadRingHead = 0;
+        pDeviceContext->BulkReadRingCount = 0;
+        detached = TRUE;
+    }
+
+    WdfSpinLockRelease(pDeviceContext->BulkReadRingLock);
+
+    return detached;
+}
+
+VOID
+OsrFxEvtBulkReadRingMapCanceledOnQueue(
+    _In_ WDFQUEUE   Queue,
+    _In_ WDFREQUEST Request
+    )
+/*++
+
+Routine Description:
+
+    Called by the framework when the map request is cancelled while it
+    waits in the bulk read ring map queue, which is also what happens to
+    it when its thread exits or the device goes away.
+
+Arguments:
+
+    Queue - Handle to the bulk read ring map queue
+
+    Request - The cancelled map request
+
+Return Value:
+
+    None
+
+--*/
+{
+    (VOID) OsrFxDetachBulkReadRing(GetDeviceContext(WdfIoQueueGetDevice(Queue)), Request);
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_IOCTL, "Bulk read ring map cancelled\n");
+
+    WdfRequestComplete(Request, STATUS_CANCELLED);
+}
+
+_IRQL_requires_(PASSIVE_LEVEL)
+NTSTATUS
+OsrFxMapBulkReadRing(
+    _In_ WDFDEVICE  Device,
+    _In_ WDFREQUEST Request
+    )
+/*++
+
+Routine Description:
+
+    Starts putting the data of the continuous reader straight into the
+    output buffer of an IOCTL_OSRUSBFX2_MAP_BULK_READ_RING request. The
+    I/O manager has locked the buffer for the request, and the driver
+    writes it through a system address, so nothing is mapped into the
+    application. From here on the oldest data is overwritten instead of
+    new data being dropped, and read requests fail, until the request
+    completes. Data the ring held for read requests is discarded.
+
+Arguments:
+
+    Device  - Handle to a framework device
+
+    Request - IOCTL_OSRUSBFX2_MAP_BULK_READ_RING request
+
+Return Value:
+
+    STATUS_PENDING if the request now waits in the map queue, otherwise
+    the status to complete it with. STATUS_DEVICE_BUSY if another map
+    request is pending.
+
+--*/
+{
+    PDEVICE_CONTEXT         pDeviceContext = GetDeviceContext(Device);
+    PBULK_READ_RING_HEADER  header;
+    NTSTATUS                status;
+    PMDL                    mdl;
+    ULONG                   length;
+
+    PAGED_CODE();
+
+    if (!pDeviceContext->BulkReadRingEnabled) {
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
+    status = WdfRequestRetrieveOutputWdmMdl(Request, &mdl);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    length = MmGetMdlByteCount(mdl);
+
+    if (length < BULK_READ_RING_HEADER_SIZE + BULK_READ_RING_MINIMUM_DATA) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    header = MmGetSystemAddressForMdlSafe(mdl, NormalPagePriority | MdlMappingNoExecute);
+    if (header == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    header->DataOffset = BULK_READ_RING_HEADER_SIZE;
+    header->DataSize = length - BULK_READ_RING_HEADER_SIZE;
+    InterlockedExchange64(&header->BytesWritten, 0);
+
+    WdfSpinLockAcquire(pDeviceContext->BulkReadRingLock);
+
+    if (pDeviceContext->BulkReadRingMapRequest != NULL) {
+        WdfSpinLockRelease(pDeviceContext->BulkReadRingLock);
+        return STATUS_DEVICE_BUSY;
+    }
+
+    pDeviceContext->BulkReadRingMapRequest = Request;
+    pDeviceContext->BulkReadRingMapHeader = header;
+    pDeviceContext->BulkReadRingMapData = (PUCHAR) header + BULK_READ_RING_HEADER_SIZE;
+    pDeviceContext->BulkReadRingMapSize = header->DataSize;
+    pDeviceContext->BulkReadRingWritten = 0;
+    pDeviceContext->BulkReadRingHead = 0;
+    pDeviceContext->BulkReadRingCount = 0;
+
+    WdfSpinLockRelease(pDeviceContext->BulkReadRingLock);
+
+    //
+    // The request is queued outside the lock, since the cancel callback
+    // takes it. Until then the request is still ours, and so is the buffer.
+    //
+    status = WdfRequestForwardToIoQueue(Request, pDeviceContext->BulkReadRingMapQueue);
+    if (!NT_SUCCESS(status)) {
+        (VOID) OsrFxDetachBulkReadRing(pDeviceContext, Request);
+        return status;
+    }
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_IOCTL,
+                "Bulk read ring mapped to a %d byte buffer\n", length);
+
+    //
+    // Fail the reads that were waiting for the ring.
+    //
+    OsrFxServiceBulkReadRing(Device, STATUS_SUCCESS);
+
+    return STATUS_PENDING;
+}
+
+_IRQL_requires_(PASSIVE_LEVEL)
+NTSTATUS
+OsrFxUnmapBulkReadRing(
+    _In_ WDFDEVICE     Device,
+    _In_ WDFFILEOBJECT FileObject
+    )
+/*++
+
+Routine Description:
+
+    Completes the map request sent on this file object, if there is one,
+    and goes back to serving read requests from the ring.
+
+Arguments:
+
+    Device  - Handle to a framework device
+
+    FileObject - File object the map request was sent on
+
+Return Value:
+
+    STATUS_INVALID_DEVICE_REQUEST if no map request is pending on this
+    file object.
+
+--*/
+{
+    PDEVICE_CONTEXT pDeviceContext = GetDeviceContext(Device);
+    WDFREQUEST      request;
+    NTSTATUS        status;
+
+    PAGED_CODE();
+
+    if (!pDeviceContext->BulkReadRingEnabled) {
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
+    status = WdfIoQueueRetrieveRequestByFileObject(pDeviceContext->BulkReadRingMapQueue,
+                                                   FileObject,
+                                                   &request);
+    if (!NT_SUCCESS(status)) {
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
+    (VOID) OsrFxDetachBulkReadRing(pDeviceContext, request);
+
+    WdfRequestComplete(request, STATUS_SUCCESS);
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_IOCTL, "Bulk read ring unmapped\n");
+
+    return STATUS_SUCCESS;
+}
+
 VOID 
 OsrFxEvtIoWrite(
     _In_ WDFQUEUE         Queue,
@@ -319,6 +319,25 @@ Return Value:
 
         break;
 
+    case IOCTL_OSRUSBFX2_MAP_BULK_READ_RING:
+
+        //
+        // The request stays pending, holding the application's buffer,
+        // until it is unmapped or cancelled.
+        //
+        status = OsrFxMapBulkReadRing(device, Request);
+        if (status == STATUS_PENDING) {
+            requestPending = TRUE;
+        }
+
+        break;
+
+    case IOCTL_OSRUSBFX2_UNMAP_BULK_READ_RING:
+
+        status = OsrFxUnmapBulkReadRing(device, WdfRequestGetFileObject(Request));
+
+        break;
+
     default :
         status = STATUS_INVALID_DEVICE_REQUEST;
         break;
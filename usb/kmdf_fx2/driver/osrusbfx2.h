@@ -48,6 +48,16 @@ Environment:
 #define _DRIVER_NAME_ "OSRUSBFX2"
 
 #define TEST_BOARD_TRANSFER_BUFFER_SIZE (64*1024)
+
+//
+// When the bulk read ring is enabled, a continuous reader keeps
+// BULK_READ_RING_READERS reads of BULK_READ_RING_TRANSFER_SIZE bytes pending
+// on the bulk IN pipe, and read requests are served from a ring of
+// BULK_READ_RING_SIZE bytes.
+//
+#define BULK_READ_RING_SIZE             TEST_BOARD_TRANSFER_BUFFER_SIZE
+#define BULK_READ_RING_TRANSFER_SIZE    4096
+#define BULK_READ_RING_READERS          4
 #define DEVICE_DESC_LENGTH 256
 
 extern const __declspec(selectany) LONGLONG DEFAULT_CONTROL_TRANSFER_TIMEOUT = 5 * -1 * WDF_TIMEOUT_TO_SEC;
@@ -100,6 +110,44 @@ typedef struct _DEVICE_CONTEXT {
 
     WDFQUEUE                        InterruptMsgQueue;
 
+    //
+    // Bulk read ring, filled by the continuous reader on the bulk IN pipe.
+    // Head is where the oldest byte is, Count how many bytes it holds.
+    //
+    BOOLEAN                         BulkReadRingEnabled;
+
+    WDFQUEUE                        BulkReadRingQueue;
+
+    WDFSPINLOCK                     BulkReadRingLock;
+
+    PUCHAR                          BulkReadRing;
+
+    ULONG                           BulkReadRingHead;
+
+    ULONG                           BulkReadRingCount;
+
+    ULONG                           BulkReadRingDropped;
+
+    //
+    // While an IOCTL_OSRUSBFX2_MAP_BULK_READ_RING request is pending, the
+    // data goes into the buffer of that request instead of the ring. The
+    // request waits in BulkReadRingMapQueue, and the fields below are set
+    // and cleared under BulkReadRingLock. BulkReadRingWritten is the
+    // authoritative count that is published to the header; the header
+    // itself is never read back since the application can write to it.
+    //
+    WDFQUEUE                        BulkReadRingMapQueue;
+
+    WDFREQUEST                      BulkReadRingMapRequest;
+
+    PBULK_READ_RING_HEADER          BulkReadRingMapHeader;
+
+    PUCHAR                          BulkReadRingMapData;
+
+    ULONG                           BulkReadRingMapSize;
+
+    LONG64                          BulkReadRingWritten;
+
     ULONG                           UsbDeviceTraits;
 
     //
@@ -246,6 +294,48 @@ EVT_WDF_USB_READER_COMPLETION_ROUTINE OsrFxEvtUsbInterruptPipeReadComplete;
 
 EVT_WDF_USB_READERS_FAILED OsrFxEvtUsbInterruptReadersFailed;
 
+_IRQL_requires_(PASSIVE_LEVEL)
+NTSTATUS
+OsrFxConfigContReaderForBulkReadEndPoint(
+    _In_ PDEVICE_CONTEXT DeviceContext
+    );
+
+EVT_WDF_USB_READER_COMPLETION_ROUTINE OsrFxEvtUsbBulkPipeReadComplete;
+
+EVT_WDF_USB_READERS_FAILED OsrFxEvtUsbBulkReadersFailed;
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+OsrFxServiceBulkReadRing(
+    _In_ WDFDEVICE Device,
+    _In_ NTSTATUS  ReaderStatus
+    );
+
+_IRQL_requires_(PASSIVE_LEVEL)
+NTSTATUS
+OsrFxMapBulkReadRing(
+    _In_ WDFDEVICE  Device,
+    _In_ WDFREQUEST Request
+    );
+
+_IRQL_requires_(PASSIVE_LEVEL)
+NTSTATUS
+OsrFxUnmapBulkReadRing(
+    _In_ WDFDEVICE     Device,
+    _In_ WDFFILEOBJECT FileObject
+    );
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+BOOLEAN
+OsrFxDetachBulkReadRing(
+    _In_ PDEVICE_CONTEXT pDeviceContext,
+    _In_ WDFREQUEST      Request
+    );
+
+EVT_WDF_IO_QUEUE_IO_CANCELED_ON_QUEUE OsrFxEvtBulkReadRingMapCanceledOnQueue;
+
+EVT_WDF_FILE_CLEANUP OsrFxEvtFileCleanup;
+
 EVT_WDF_IO_QUEUE_IO_STOP OsrFxEvtIoStop;
 
 EVT_WDF_DEVICE_D0_ENTRY OsrFxEvtDeviceD0Entry;
@@ -170,4 +170,45 @@ typedef struct _SWITCH_STATE {
                                                     METHOD_OUT_DIRECT, \
                                                     FILE_READ_ACCESS)
 
+//
+// Have the data of the bulk read ring put straight into a buffer of the
+// application. Only available when the driver serves reads from the ring
+// (BulkReadRing in the INF). The output buffer holds a BULK_READ_RING_HEADER
+// in its first BULK_READ_RING_HEADER_SIZE bytes and the data after that, and
+// must have room for at least BULK_READ_RING_MINIMUM_DATA bytes of data. The
+// driver locks the buffer and keeps the request pending, so the handle must
+// be opened for overlapped I/O. IOCTL_OSRUSBFX2_UNMAP_BULK_READ_RING on the
+// same handle completes the request; so do cancelling it and closing the
+// handle. The buffer belongs to the driver until the request has completed.
+// Meanwhile read requests fail with STATUS_DEVICE_BUSY.
+//
+#define IOCTL_OSRUSBFX2_MAP_BULK_READ_RING CTL_CODE(FILE_DEVICE_OSRUSBFX2, \
+                                                    IOCTL_INDEX + 10, \
+                                                    METHOD_OUT_DIRECT, \
+                                                    FILE_READ_ACCESS)
+
+#define IOCTL_OSRUSBFX2_UNMAP_BULK_READ_RING CTL_CODE(FILE_DEVICE_OSRUSBFX2, \
+                                                    IOCTL_INDEX + 11, \
+                                                    METHOD_BUFFERED, \
+                                                    FILE_READ_ACCESS)
+
+#define BULK_READ_RING_HEADER_SIZE      4096
+#define BULK_READ_RING_MINIMUM_DATA     4096
+
+//
+// The buffer starts with this header. Byte N of the data received since
+// the request was sent is at DataOffset + (N % DataSize) from the start of
+// the buffer. The driver stores the data before it advances BytesWritten,
+// and never waits for the application: once BytesWritten is more than
+// DataSize ahead of what the application has consumed, the oldest data has
+// been overwritten. The driver only ever writes to the buffer.
+//
+typedef struct _BULK_READ_RING_HEADER {
+
+    ULONG               DataOffset;
+    ULONG               DataSize;
+    volatile LONG64     BytesWritten;
+
+} BULK_READ_RING_HEADER, *PBULK_READ_RING_HEADER;
+
 #endif
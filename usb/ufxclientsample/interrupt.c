@@ -30,6 +30,14 @@ EVT_WDF_INTERRUPT_ISR DeviceInterrupt_EvtInterruptIsr;
 EVT_WDF_INTERRUPT_DPC DeviceInterrupt_EvtInterruptDpc;
 EVT_WDF_INTERRUPT_ISR DeviceInterrupt_EvtAttachDetachInterruptIsr;
 
+_IRQL_requires_(DISPATCH_LEVEL)
+BOOLEAN
+InterruptGetNextEvent (
+    _In_ PDEVICE_INTERRUPT_CONTEXT InterruptContext,
+    _In_ ULONG EventIndex,
+    _Out_ CONTROLLER_EVENT *ControllerEvent
+    );
+
 _Must_inspect_result_
 _IRQL_requires_max_(PASSIVE_LEVEL)
 NTSTATUS
@@ -157,6 +165,13 @@ Return Value:
     PendingEvents = TRUE;
 
     if (PendingEvents) {
+        //
+        // #### TODO: Insert code to mask the event interrupt. ####
+        //
+        // Events that arrive until the DPC has drained the event buffer are
+        // then picked up by that DPC, instead of raising an interrupt each.
+        //
+
         //    
         // Enqueue the DPC to handle the events.
         //
@@ -193,8 +208,7 @@ Arguments:
     BOOLEAN Attached;
     BOOLEAN GotAttachOrDetach;
     CONTROLLER_EVENT ControllerEvent;
-
-    UNREFERENCED_PARAMETER(Interrupt);
+    ULONG Events;
 
     TraceEntry();
 
@@ -234,24 +248,54 @@ Arguments:
     InterruptContext = DeviceInterruptGetContext(ControllerContext->DeviceInterrupt);
 
     //
-    // #### TODO: Insert code to read and dispatch events from the controller ####
-    // 
+    // Handle all the events the controller has written to the event buffer,
+    // up to MAX_EVENTS_PER_DPC.
+    //
+    for (Events = 0; Events < MAX_EVENTS_PER_DPC; Events++) {
+
+        if (!InterruptGetNextEvent(InterruptContext, Events, &ControllerEvent)) {
+            break;
+        }
+
+        switch (ControllerEvent.Type) {
+        case EventTypeDevice:
+            HandleDeviceEvent(WdfDevice,  ControllerEvent.u.DeviceEvent);
+            break;
+
+        case EventTypeEndpoint:
+            HandleEndpointEvent(WdfDevice, ControllerEvent.u.EndpointEvent);
+            break;
+        }
+    }
 
-    // The sample will assume an endpoint event of EndpointEventTransferComplete
-    ControllerEvent.Type = EventTypeEndpoint;
-    ControllerEvent.u.EndpointEvent = EndpointEventTransferComplete;
-    
     //
-    // Handle events from the controller
+    // #### TODO: Insert code to return the handled entries to the controller with a single write of Events to the event count register ####
     //
-    switch (ControllerEvent.Type) {
-    case EventTypeDevice:
-        HandleDeviceEvent(WdfDevice,  ControllerEvent.u.DeviceEvent);
-        break;
-
-    case EventTypeEndpoint:
-        HandleEndpointEvent(WdfDevice, ControllerEvent.u.EndpointEvent);
-        break;
+
+    InterruptContext->Dpcs += 1;
+    InterruptContext->EventsHandled += Events;
+    if (Events > InterruptContext->MaxEventsPerDpc) {
+        InterruptContext->MaxEventsPerDpc = Events;
+    }
+
+    if (InterruptContext->Dpcs % EVENT_TRACE_INTERVAL == 0) {
+        TraceInformation("%d events in %d DPCs, %d events per DPC on average, %d at most",
+            InterruptContext->EventsHandled,
+            InterruptContext->Dpcs,
+            InterruptContext->EventsHandled / InterruptContext->Dpcs,
+            InterruptContext->MaxEventsPerDpc);
+    }
+
+    if (Events == MAX_EVENTS_PER_DPC) {
+        //
+        // There may be more. Let other DPCs run before handling them.
+        //
+        WdfInterruptQueueDpcForIsr(Interrupt);
+
+    } else {
+        //
+        // #### TODO: Insert code to unmask the event interrupt ####
+        //
     }
 
     WdfSpinLockRelease(ControllerContext->DpcLock);
@@ -259,6 +303,48 @@ Arguments:
     TraceExit();
 }
 
+_IRQL_requires_(DISPATCH_LEVEL)
+BOOLEAN
+InterruptGetNextEvent (
+    _In_ PDEVICE_INTERRUPT_CONTEXT InterruptContext,
+    _In_ ULONG EventIndex,
+    _Out_ CONTROLLER_EVENT *ControllerEvent
+    )
+/*++
+
+Routine Description:
+
+    Reads the next entry of the event buffer, if the controller has
+    written one.
+
+Arguments:
+
+    InterruptContext - Context of the device interrupt, which holds the
+                       event buffer.
+
+    EventIndex - How many entries this DPC has already handled.
+
+    ControllerEvent - Receives the event.
+
+Return Value:
+
+    TRUE if there was an event, FALSE if the event buffer is empty.
+
+--*/
+{
+    UNREFERENCED_PARAMETER(InterruptContext);
+
+    //
+    // #### TODO: Insert code to read the next entry from the event buffer ####
+    // 
+
+    // The sample will assume a single endpoint event of EndpointEventTransferComplete
+    ControllerEvent->Type = EventTypeEndpoint;
+    ControllerEvent->u.EndpointEvent = EndpointEventTransferComplete;
+
+    return (EventIndex == 0);
+}
+
 BOOLEAN 
 DeviceInterrupt_EvtAttachDetachInterruptIsr (
     _In_ WDFINTERRUPT Interrupt,
@@ -19,6 +19,14 @@ Environment:
 
 #include "registers.h"
 
+//
+// The DPC handles at most MAX_EVENTS_PER_DPC event buffer entries, then
+// queues itself again so that a busy controller doesn't hold the processor.
+// The event counters are traced every EVENT_TRACE_INTERVAL DPCs.
+//
+#define MAX_EVENTS_PER_DPC 64
+#define EVENT_TRACE_INTERVAL 1024
+
 //
 // Context space for device WDFINTERRUPT object 
 //
@@ -26,6 +34,16 @@ typedef struct _DEVICE_INTERRUPT_CONTEXT {
 
     WDFCOMMONBUFFER Buffer;
 
+    //
+    // Event buffer entries handled, and how many DPCs handled them.
+    // Only touched in the DPC, under the DPC lock.
+    //
+    ULONG Dpcs;
+
+    ULONG EventsHandled;
+
+    ULONG MaxEventsPerDpc;
+
 } DEVICE_INTERRUPT_CONTEXT, *PDEVICE_INTERRUPT_CONTEXT;
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(DEVICE_INTERRUPT_CONTEXT, DeviceInterruptGetContext)
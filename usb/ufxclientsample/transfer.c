@@ -353,6 +353,63 @@ Parameters Description:
     TraceExit();
 }
 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+TransferRingDoorbell (
+    _In_ UFXENDPOINT Endpoint,
+    _In_ ULONG Trbs
+    )
+/*++
+Routine Description:
+
+    Hands a batch of transfer structures to the controller with a single
+    Start or Update Transfer command, and updates the doorbell counters.
+    Called with the transfer lock held.
+
+Parameters Description:
+
+    Endpoint - The endpoint on which to transfer.
+
+    Trbs - How many transfer structures were written since the last
+           doorbell.
+
+--*/
+{
+    PTRANSFER_CONTEXT TransferContext;
+
+    TraceEntry();
+
+    TransferContext = UfxEndpointGetTransferContext(Endpoint);
+
+    //
+    // Nothing new for the controller to fetch. An Update Transfer command
+    // would only cost a command round trip.
+    //
+    if (Trbs == 0 && TransferContext->TransferStarted) {
+        goto End;
+    }
+
+    TransferCommandStartOrUpdate(Endpoint);
+
+    TransferContext->Doorbells += 1;
+    TransferContext->TrbsQueued += Trbs;
+    if (Trbs > TransferContext->MaxTrbsPerDoorbell) {
+        TransferContext->MaxTrbsPerDoorbell = Trbs;
+    }
+
+    if (TransferContext->Doorbells % TRANSFER_DOORBELL_TRACE_INTERVAL == 0) {
+        TraceInformation("ENDPOINT %d: %d doorbells, %d TRBs, %d TRBs per doorbell on average, %d at most",
+            UfxEndpointGetContext(Endpoint)->PhysicalEndpoint,
+            TransferContext->Doorbells,
+            TransferContext->TrbsQueued,
+            TransferContext->TrbsQueued / TransferContext->Doorbells,
+            TransferContext->MaxTrbsPerDoorbell);
+    }
+
+End:
+    TraceExit();
+}
+
 VOID
 TransferDmaExecute (
     _In_opt_ WDFDMATRANSACTION Transaction
@@ -766,12 +823,14 @@ Return Value:
     PTRANSFER_CONTEXT TransferContext;
     PDMA_CONTEXT DmaContext;
     PUFXENDPOINT_CONTEXT EpContext;
+    ULONG Trbs;
 
     TraceEntry();
     
     TransferContext = UfxEndpointGetTransferContext(Endpoint);
     EpContext = UfxEndpointGetContext(Endpoint);
     DmaContext = DmaGetContext(Transaction);
+    Trbs = 0;
 
     DmaContext->BytesProgrammedCurrent = 0;
     DmaContext->BytesRemaining = 0;
@@ -779,7 +838,9 @@ Return Value:
     TRACE_TRANSFER("PROGRAMMING", Endpoint, DmaContext->Request);
 
     //
-    // Try to program transfer structures
+    // Try to program transfer structures. All of them are written before the
+    // controller is told about any, so that the whole scatter gather list
+    // costs one doorbell instead of one per element.
     //
     while (DmaContext->SgIndex < DmaContext->SgList->NumberOfElements) {
         PSCATTER_GATHER_ELEMENT Sg;
@@ -795,6 +856,11 @@ Return Value:
         //
         // #### TODO: Insert code to map scatter gather buffers to controller transfer structures ####
         //
+        // Chain each structure to the next and leave the ownership bit of the
+        // first one clear until the batch is complete, so the controller
+        // never fetches a partial batch.
+        //
+        Trbs += 1;
         
         //
         // Need to remember how much we really programmed
@@ -820,6 +886,7 @@ Return Value:
         //
         // #### TODO: Insert code to append an extra buffer to the transfer structures #### 
         //
+        Trbs += 1;
         
     }
 
@@ -828,10 +895,14 @@ Return Value:
     //
     DmaContext->BytesRemaining = DmaContext->BytesProgrammedCurrent;
 
+    //
+    // #### TODO: Insert code to hand the batch to the controller by setting the ownership bit of its first transfer structure ####
+    //
+
     //
     // Finally, send the command to start or continue this transfer.
     //
-    TransferCommandStartOrUpdate(Endpoint);
+    TransferRingDoorbell(Endpoint, Trbs);
 
     TRACE_TRANSFER("PROGRAMMING--", Endpoint, DmaContext->Request);
 
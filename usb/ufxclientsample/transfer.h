@@ -24,6 +24,12 @@ Environment:
 
 #define MAX_TRANSFER_SIZE 0x20000000
 
+//
+// The doorbell counters of an endpoint are traced every
+// TRANSFER_DOORBELL_TRACE_INTERVAL doorbells.
+//
+#define TRANSFER_DOORBELL_TRACE_INTERVAL 256
+
 // nonstandard extension used : bit field types other than int
 #pragma warning(disable:4214)
 
@@ -62,6 +68,15 @@ typedef struct _TRANSFER_CONTEXT {
     BOOLEAN CleanupOnEndComplete;
     WDFWORKITEM CompletionWorkItem;
     BOOLEAN PendingCompletion;
+
+    //
+    // Transfer structures (TRBs) are written in batches, and each batch
+    // is handed to the controller with one Start or Update Transfer
+    // command. These count the doorbells and the TRBs they covered.
+    //
+    ULONG Doorbells;
+    ULONG TrbsQueued;
+    ULONG MaxTrbsPerDoorbell;
 } TRANSFER_CONTEXT, *PTRANSFER_CONTEXT;
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(TRANSFER_CONTEXT, UfxEndpointGetTransferContext);
@@ -66,6 +66,8 @@ BOOL fCompareData = TRUE;
 int gDebugLevel = 1;      // higher == more verbose, default is 1, 0 turns off all
 
 ULONG IterationCount = 1; //count of iterations of the test we are to perform
+ULONG MaxBulkStages = 0;  // if not 0, measure throughput for 1 to this many bulk stages in flight
+ULONG RingSeconds = 0;    // if not 0, run an isoch ring on the input pipe for this many seconds
 int WriteLen = 0;         // #bytes to write
 int ReadLen = 0;          // #bytes to read
 
@@ -430,6 +432,8 @@ Return Value:
         printf("-r [n] where n is number of bytes to read\n");
         printf("-w [n] where n is number of bytes to write\n");
         printf("-c [n] where n is number of iterations (default = 1)\n");
+        printf("-t [n] to measure throughput with 1 to n bulk stages in flight (n <= 8)\n");
+        printf("-y [n] to run an isoch ring of -r bytes on the input pipe for n seconds\n");
         printf("-i [s] where s is the input pipe\n");
         printf("-o [s] where s is the output pipe\n");
         printf("-v verbose -- dumps read data\n");
@@ -519,6 +523,36 @@ Return Value:
                 }
                 i++;
                 break;
+            case 't':
+            case 'T':
+                if (i+1 >= argc) {
+                    usage();
+                    exit(1);
+                }
+                else {
+                    MaxBulkStages = atoi(&argv[i+1][0]);
+                    if (MaxBulkStages == 0 || MaxBulkStages > 8) {
+                        usage();
+                        exit(1);
+                    }
+                }
+                i++;
+                break;
+            case 'y':
+            case 'Y':
+                if (i+1 >= argc) {
+                    usage();
+                    exit(1);
+                }
+                else {
+                    RingSeconds = atoi(&argv[i+1][0]);
+                    if (RingSeconds == 0) {
+                        usage();
+                        exit(1);
+                    }
+                }
+                i++;
+                break;
             case 'i':
             case 'I':
                 if (i+1 >= argc) {
@@ -1153,6 +1187,207 @@ Return Value:
 //  End, routines for USB configuration and pipe info dump  (Cmdline "rwbulk -u" )
 
 
+void
+measure_bulk_stages(
+    _In_ HANDLE hRead,
+    _In_ HANDLE hWrite,
+    _In_opt_ char *pinBuf,
+    _In_opt_ char *poutBuf
+    )
+/*++
+Routine Description:
+
+    Called by main() to time IterationCount writes and reads with each
+    number of bulk stages in flight from 1 to MaxBulkStages, and print
+    the throughput of each.
+
+Arguments:
+
+    hRead, hWrite  handles to the input and output pipes, if open
+    pinBuf, poutBuf  buffers of ReadLen and WriteLen bytes
+
+Return Value:
+
+    None
+
+--*/
+{
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    LONGLONG readTicks;
+    LONGLONG writeTicks;
+    ULONGLONG bytesRead;
+    ULONGLONG bytesWritten;
+    ULONG  stages;
+    ULONG  i;
+    ULONG  nBytes;
+    HANDLE hDev;
+
+    hDev = (hWrite != INVALID_HANDLE_VALUE) ? hWrite : hRead;
+    if (hDev == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    QueryPerformanceFrequency(&frequency);
+
+    for (stages = 1; stages <= MaxBulkStages; stages++) {
+
+        if (!DeviceIoControl(hDev,
+                             IOCTL_USBSAMP_SET_BULK_STAGES,
+                             &stages,
+                             sizeof(stages),
+                             NULL,
+                             0,
+                             &nBytes,
+                             NULL)) {
+            printf("Failed to set %u bulk stages in flight, error %u\n", stages, GetLastError());
+            return;
+        }
+
+        readTicks = writeTicks = 0;
+        bytesRead = bytesWritten = 0;
+
+        for (i=0; i<IterationCount; i++) {
+
+            if (poutBuf && hWrite != INVALID_HANDLE_VALUE) {
+
+                QueryPerformanceCounter(&start);
+                if (WriteFile(hWrite, poutBuf, WriteLen, &nBytes, NULL)) {
+                    bytesWritten += nBytes;
+                }
+                QueryPerformanceCounter(&end);
+                writeTicks += end.QuadPart - start.QuadPart;
+            }
+
+            if (pinBuf && hRead != INVALID_HANDLE_VALUE) {
+
+                QueryPerformanceCounter(&start);
+                if (ReadFile(hRead, pinBuf, ReadLen, &nBytes, NULL)) {
+                    bytesRead += nBytes;
+                }
+                QueryPerformanceCounter(&end);
+                readTicks += end.QuadPart - start.QuadPart;
+            }
+        }
+
+        printf("%u stage(s) in flight :", stages);
+        if (writeTicks) {
+            printf(" write %8.2f MB/s", (double) bytesWritten * frequency.QuadPart / writeTicks / (1024 * 1024));
+        }
+        if (readTicks) {
+            printf(" read %8.2f MB/s", (double) bytesRead * frequency.QuadPart / readTicks / (1024 * 1024));
+        }
+        printf("\n");
+    }
+}
+
+typedef struct _RING_THREAD_PARAMS {
+    HANDLE hRead;
+    PUSBSAMP_ISOCH_RING_HEADER Ring;
+    ULONG  RingLength;
+} RING_THREAD_PARAMS, *PRING_THREAD_PARAMS;
+
+DWORD
+WINAPI
+ring_thread(
+    _In_ LPVOID Parameter
+    )
+/*++
+Routine Description:
+
+    Sends IOCTL_USBSAMP_START_ISOCH_RING, which stays pending until
+    run_isoch_ring cancels it.
+
+--*/
+{
+    PRING_THREAD_PARAMS params = (PRING_THREAD_PARAMS) Parameter;
+    USBSAMP_ISOCH_RING_PARAMETERS ringParams;
+    ULONG nBytes;
+
+    ringParams.NumberOfUrbs = 4;
+    ringParams.FramesPerUrb = 0;
+
+    if (!DeviceIoControl(params->hRead,
+                         IOCTL_USBSAMP_START_ISOCH_RING,
+                         &ringParams,
+                         sizeof(ringParams),
+                         params->Ring,
+                         params->RingLength,
+                         &nBytes,
+                         NULL)) {
+        return GetLastError();
+    }
+
+    return ERROR_SUCCESS;
+}
+
+void
+run_isoch_ring(
+    _In_ HANDLE hRead
+    )
+/*++
+Routine Description:
+
+    Called by main() to run an isoch ring of ReadLen bytes on the input
+    pipe for RingSeconds seconds, printing the ring counters every second.
+
+Arguments:
+
+    hRead  handle to the input pipe
+
+Return Value:
+
+    None
+
+--*/
+{
+    RING_THREAD_PARAMS params;
+    HANDLE hThread;
+    DWORD  error = ERROR_SUCCESS;
+    ULONGLONG lastBytes = 0;
+    ULONG  i;
+
+    params.hRead = hRead;
+    params.RingLength = sizeof(USBSAMP_ISOCH_RING_HEADER) + ReadLen;
+    params.Ring = (PUSBSAMP_ISOCH_RING_HEADER) calloc(1, params.RingLength);
+
+    if (params.Ring == NULL) {
+        return;
+    }
+
+    hThread = CreateThread(NULL, 0, ring_thread, &params, 0, NULL);
+
+    if (hThread == NULL) {
+        free(params.Ring);
+        return;
+    }
+
+    for (i = 0; i < RingSeconds; i++) {
+
+        if (WaitForSingleObject(hThread, 1000) == WAIT_OBJECT_0) {
+            break;
+        }
+
+        printf("<%s> ring (%04.4u) : %8.2f KB/s, %I64u packets received, %I64u missed\n",
+               inPipe, i,
+               (double) (params.Ring->BytesWritten - lastBytes) / 1024,
+               params.Ring->PacketsReceived,
+               params.Ring->PacketsMissed);
+
+        lastBytes = params.Ring->BytesWritten;
+    }
+
+    CancelSynchronousIo(hThread);
+    WaitForSingleObject(hThread, INFINITE);
+    GetExitCodeThread(hThread, &error);
+    CloseHandle(hThread);
+
+    printf("<%s> ring stopped, error %u, status 0x%x\n", inPipe, error, params.Ring->Status);
+
+    free(params.Ring);
+}
+
 
 int 
 _cdecl 
@@ -1226,6 +1461,18 @@ Return Value:
             poutBuf = (char*)malloc(WriteLen);
         }
 
+        if (RingSeconds && hRead != INVALID_HANDLE_VALUE) {
+
+            run_isoch_ring(hRead);
+            IterationCount = 0;
+        }
+
+        if (MaxBulkStages) {
+
+            measure_bulk_stages(hRead, hWrite, pinBuf, poutBuf);
+            IterationCount = 0;
+        }
+
         for (i=0; i<IterationCount; i++) {
 
             if (fWrite && poutBuf && hWrite != INVALID_HANDLE_VALUE) {
@@ -76,6 +76,7 @@ Return Value:
     PDEVICE_CONTEXT         deviceContext;
     ULONG                   maxTransferSize;
     PPIPE_CONTEXT           pipeContext;
+    ULONG                   stagesInFlight;
 
     UsbSamp_DbgPrint(3, ("UsbSamp_DispatchReadWrite - begins\n"));
 
@@ -157,6 +158,46 @@ Return Value:
         stageLength = totalLength;
     }
 
+#if (NTDDI_VERSION >= NTDDI_WIN8)
+    if(WdfUsbPipeTypeBulk == pipeInfo.PipeType &&
+        pipeContext->StreamConfigured == TRUE) {
+        //
+        // For super speed bulk pipe with streams, we specify one of its associated 
+        // usbd pipe handles to format an URB for sending or receiving data. 
+        // The usbd pipe handle is returned by the HCD via sucessful open-streams request
+        //
+        usbdPipeHandle = AcquireStreamForRequest(Request, pipe);
+    }
+    else {
+        usbdPipeHandle = WdfUsbTargetPipeWdmGetPipeHandle(pipe);
+    }
+#else
+    usbdPipeHandle = WdfUsbTargetPipeWdmGetPipeHandle(pipe);
+#endif
+
+    //
+    // A bulk transfer of more than one stage can keep several stages in
+    // flight, so that the bus isn't idle while a completed stage is sent
+    // again.
+    //
+    stagesInFlight = (ULONG) deviceContext->BulkStagesInFlight;
+
+    if (stagesInFlight > 1 &&
+        WdfUsbPipeTypeBulk == pipeInfo.PipeType &&
+        totalLength > stageLength) {
+
+        StartBulkStages(deviceContext,
+                        Request,
+                        pipe,
+                        usbdPipeHandle,
+                        requestMdl,
+                        totalLength,
+                        stageLength,
+                        urbFlags,
+                        stagesInFlight);
+        return;
+    }
+
     newMdl = IoAllocateMdl((PVOID) virtualAddress,
                            totalLength,
                            FALSE,
@@ -190,23 +231,6 @@ Return Value:
         goto Exit;
     }
 
-#if (NTDDI_VERSION >= NTDDI_WIN8)
-    if(WdfUsbPipeTypeBulk == pipeInfo.PipeType &&
-        pipeContext->StreamConfigured == TRUE) {
-        //
-        // For super speed bulk pipe with streams, we specify one of its associated 
-        // usbd pipe handles to format an URB for sending or receiving data. 
-        // The usbd pipe handle is returned by the HCD via sucessful open-streams request
-        //
-        usbdPipeHandle = GetStreamPipeHandleFromBulkPipe(pipe);
-    }
-    else {
-        usbdPipeHandle = WdfUsbTargetPipeWdmGetPipeHandle(pipe);
-    }
-#else
-    usbdPipeHandle = WdfUsbTargetPipeWdmGetPipeHandle(pipe);
-#endif
-
     UsbBuildInterruptOrBulkTransferRequest(urb,
                                            sizeof(struct _URB_BULK_OR_INTERRUPT_TRANSFER),
                                            usbdPipeHandle,
@@ -241,6 +265,7 @@ Return Value:
 
 Exit:
     if (!NT_SUCCESS(status)) {
+        ReleaseStreamForRequest(Request);
         WdfRequestCompleteWithInformation(Request, status, 0);
 
         if (newMdl != NULL) {
@@ -424,11 +449,571 @@ End:
     UsbSamp_DbgPrint(3, ("%s request completed with status 0x%x\n",
                                                     operation, status));
 
+    ReleaseStreamForRequest(Request);
+
     WdfRequestComplete(Request, status);
 
     return;
 }
 
+VOID
+StartBulkStages(
+    _In_ PDEVICE_CONTEXT  DeviceContext,
+    _In_ WDFREQUEST       Request,
+    _In_ WDFUSBPIPE       Pipe,
+    _In_ USBD_PIPE_HANDLE UsbdPipeHandle,
+    _In_ PMDL             RequestMdl,
+    _In_ ULONG            TotalLength,
+    _In_ ULONG            StageLength,
+    _In_ ULONG            UrbFlags,
+    _In_ ULONG            StagesInFlight
+    )
+/*++
+
+Routine Description:
+
+    This routine performs a bulk transfer with up to StagesInFlight stages
+    pending in the USB stack at a time. Each stage is carried by a request
+    the driver creates, with its own partial MDL and URB. When a stage
+    completes, the same request is sent again for the next stage that
+    hasn't been sent yet. The user request is completed once all the
+    stages have completed.
+
+    A read stage that comes back short ends the transfer. The stages after
+    it are cancelled, and the request completes with the data up to the
+    short packet.
+
+Arguments:
+
+    DeviceContext - Device context
+
+    Request - The user read or write request
+
+    Pipe - The bulk pipe of the request
+
+    UsbdPipeHandle - The pipe handle to format the URBs with
+
+    RequestMdl - The MDL of the user buffer
+
+    TotalLength - Length of the transfer
+
+    StageLength - Maximum length of a stage
+
+    UrbFlags - Transfer flags of the URBs
+
+    StagesInFlight - Number of stages to keep pending
+
+Return Value:
+
+    VOID
+
+--*/
+{
+    PREQUEST_CONTEXT        rwContext;
+    PBULK_STAGE_CONTEXT     stageContext;
+    WDF_OBJECT_ATTRIBUTES   objectAttribs;
+    WDFREQUEST              stage;
+    PURB                    urb;
+    NTSTATUS                status = STATUS_SUCCESS;
+    ULONG                   i;
+
+    rwContext = GetRequestContext(Request);
+
+    rwContext->Pipe             = Pipe;
+    rwContext->UsbdPipeHandle   = UsbdPipeHandle;
+    rwContext->RequestMdl       = RequestMdl;
+    rwContext->VirtualAddress   = (ULONG_PTR) MmGetMdlVirtualAddress(RequestMdl);
+    rwContext->UrbFlags         = UrbFlags;
+    rwContext->TotalLength      = TotalLength;
+    rwContext->StageLength      = StageLength;
+    rwContext->NumStages        = 0;
+    rwContext->NextOffset       = 0;
+    rwContext->BytesTransferred = 0;
+    rwContext->ShortEnd         = (LONG) TotalLength;
+    rwContext->Stopping         = FALSE;
+    rwContext->ResetQueued      = FALSE;
+    rwContext->Status           = STATUS_SUCCESS;
+
+    StagesInFlight = min(StagesInFlight, (TotalLength + StageLength - 1) / StageLength);
+
+    UsbSamp_DbgPrint(3, ("Bulk transfer of %d bytes in stages of %d, %d in flight\n",
+                         TotalLength, StageLength, StagesInFlight));
+
+    for (i = 0; i < StagesInFlight; i++) {
+
+        WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&objectAttribs, BULK_STAGE_CONTEXT);
+        objectAttribs.ParentObject = Request;
+
+        status = WdfRequestCreate(&objectAttribs,
+                                  WdfUsbTargetPipeGetIoTarget(Pipe),
+                                  &stage);
+        if (!NT_SUCCESS(status)) {
+            UsbSamp_DbgPrint(1, ("WdfRequestCreate for bulk stage failed %x\n", status));
+            break;
+        }
+
+        stageContext = GetBulkStageContext(stage);
+        stageContext->MainRequest = Request;
+        stageContext->Mdl = NULL;
+
+        rwContext->Stages[rwContext->NumStages++] = stage;
+
+        //
+        // The MDL is allocated for the whole buffer, as a stage that isn't
+        // page aligned may span one more page than a stage that is.
+        //
+        stageContext->Mdl = IoAllocateMdl((PVOID) rwContext->VirtualAddress,
+                                          TotalLength,
+                                          FALSE,
+                                          FALSE,
+                                          NULL);
+        if (stageContext->Mdl == NULL) {
+            UsbSamp_DbgPrint(1, ("Failed to alloc mem for mdl\n"));
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        WDF_OBJECT_ATTRIBUTES_INIT(&objectAttribs);
+        objectAttribs.ParentObject = stage;
+
+        status = WdfUsbTargetDeviceCreateUrb(DeviceContext->WdfUsbTargetDevice,
+                                             &objectAttribs,
+                                             &stageContext->UrbMemory,
+                                             &urb);
+        if (!NT_SUCCESS(status)) {
+            UsbSamp_DbgPrint(1, ("WdfUsbTargetDeviceCreateUrb failed %x\n", status));
+            break;
+        }
+    }
+
+    //
+    // One reference for the stages and one for the cancel routine, which
+    // cancels the stages in flight. It can run as soon as the request is
+    // cancelable.
+    //
+    rwContext->StagesActive = (LONG) rwContext->NumStages;
+    rwContext->References = 2;
+
+    if (NT_SUCCESS(status)) {
+        status = WdfRequestMarkCancelableEx(Request, UsbSamp_EvtBulkTransferCancel);
+    }
+
+    if (!NT_SUCCESS(status)) {
+
+        rwContext->Status = status;
+        rwContext->References = 1;
+        ReleaseBulkTransfer(Request);
+        return;
+    }
+
+    for (i = 0; i < rwContext->NumStages; i++) {
+
+        if (!SendBulkStage(rwContext->Stages[i])) {
+            RetireBulkStage(Request);
+        }
+    }
+
+    return;
+}
+
+BOOLEAN
+SendBulkStage(
+    _In_ WDFREQUEST Stage
+    )
+/*++
+
+Routine Description:
+
+    This routine sends the next stage of a bulk transfer that hasn't been
+    sent yet, if any, with the request of a stage that is not pending.
+
+Arguments:
+
+    Stage - The request of the stage
+
+Return Value:
+
+    TRUE if the stage was sent. If not, the caller retires the stage.
+
+--*/
+{
+    PBULK_STAGE_CONTEXT     stageContext;
+    PREQUEST_CONTEXT        rwContext;
+    WDFREQUEST              request;
+    WDF_REQUEST_REUSE_PARAMS reuseParams;
+    PURB                    urb;
+    LONG                    offset;
+    ULONG                   stageLength;
+    NTSTATUS                status;
+
+    stageContext = GetBulkStageContext(Stage);
+    request = stageContext->MainRequest;
+    rwContext = GetRequestContext(request);
+
+    if (rwContext->Stopping) {
+        return FALSE;
+    }
+
+    offset = InterlockedExchangeAdd(&rwContext->NextOffset, (LONG) rwContext->StageLength);
+    if ((ULONG) offset >= rwContext->TotalLength) {
+        return FALSE;
+    }
+
+    stageLength = min(rwContext->StageLength, rwContext->TotalLength - offset);
+
+    stageContext->Offset = (ULONG) offset;
+    stageContext->Length = stageLength;
+
+    WDF_REQUEST_REUSE_PARAMS_INIT(&reuseParams, WDF_REQUEST_REUSE_NO_FLAGS, STATUS_SUCCESS);
+    status = WdfRequestReuse(Stage, &reuseParams);
+    if (!NT_SUCCESS(status)) {
+        UsbSamp_DbgPrint(1, ("WdfRequestReuse failed %x\n", status));
+        goto Error;
+    }
+
+    //
+    // Following call is required to free any mapping made on the partial MDL
+    // and reset internal MDL state.
+    //
+    MmPrepareMdlForReuse(stageContext->Mdl);
+
+    IoBuildPartialMdl(rwContext->RequestMdl,
+                      stageContext->Mdl,
+                      (PVOID) (rwContext->VirtualAddress + offset),
+                      stageLength);
+
+    urb = (PURB) WdfMemoryGetBuffer(stageContext->UrbMemory, NULL);
+
+    UsbBuildInterruptOrBulkTransferRequest(urb,
+                                           sizeof(struct _URB_BULK_OR_INTERRUPT_TRANSFER),
+                                           rwContext->UsbdPipeHandle,
+                                           NULL,
+                                           stageContext->Mdl,
+                                           stageLength,
+                                           rwContext->UrbFlags,
+                                           NULL);
+
+    status = WdfUsbTargetPipeFormatRequestForUrb(rwContext->Pipe,
+                                                 Stage,
+                                                 stageContext->UrbMemory,
+                                                 NULL);
+    if (!NT_SUCCESS(status)) {
+        UsbSamp_DbgPrint(1, ("Failed to format requset for urb\n"));
+        goto Error;
+    }
+
+    WdfRequestSetCompletionRoutine(Stage, UsbSamp_EvtBulkStageCompletion, NULL);
+
+    //
+    // The stage can complete, and the whole transfer with it, before
+    // WdfRequestSend returns. Keep both requests until this routine is done
+    // with them.
+    //
+    WdfObjectReference(request);
+    WdfObjectReference(Stage);
+
+    if (!WdfRequestSend(Stage, WdfUsbTargetPipeGetIoTarget(rwContext->Pipe), WDF_NO_SEND_OPTIONS)) {
+
+        status = WdfRequestGetStatus(Stage);
+        WdfObjectDereference(Stage);
+        WdfObjectDereference(request);
+        UsbSamp_DbgPrint(1, ("WdfRequestSend for bulk stage failed %x\n", status));
+        goto Error;
+    }
+
+    //
+    // If the transfer was stopped while this stage was being formatted,
+    // StopBulkStages had nothing to cancel for it.
+    //
+    if (rwContext->Stopping) {
+        WdfRequestCancelSentRequest(Stage);
+    }
+
+    WdfObjectDereference(Stage);
+    WdfObjectDereference(request);
+
+    return TRUE;
+
+Error:
+    StopBulkStages(rwContext, status);
+
+    return FALSE;
+}
+
+VOID
+UsbSamp_EvtBulkStageCompletion(
+    _In_ WDFREQUEST                  Request,
+    _In_ WDFIOTARGET                 Target,
+    PWDF_REQUEST_COMPLETION_PARAMS CompletionParams,
+    _In_ WDFCONTEXT                  Context
+    )
+/*++
+
+Routine Description:
+
+    This is the completion routine for a stage of a bulk transfer. If the
+    stage succeeded, the request is sent again for the next stage.
+
+Arguments:
+
+    Request - The request of the stage
+
+    Target - The pipe I/O target
+
+    CompletionParams - Request completion params
+
+    Context - Unused
+
+Return Value:
+    None
+
+--*/
+{
+    PBULK_STAGE_CONTEXT     stageContext;
+    PREQUEST_CONTEXT        rwContext;
+    WDFREQUEST              request;
+    NTSTATUS                status;
+    PURB                    urb;
+    ULONG                   bytesReadWritten;
+    LONG                    end;
+    LONG                    shortEnd;
+
+    UNREFERENCED_PARAMETER(Context);
+
+    stageContext = GetBulkStageContext(Request);
+    request = stageContext->MainRequest;
+    rwContext = GetRequestContext(request);
+
+    status = CompletionParams->IoStatus.Status;
+
+    if (NT_SUCCESS(status)) {
+
+        urb = (PURB) WdfMemoryGetBuffer(stageContext->UrbMemory, NULL);
+        bytesReadWritten = urb->UrbBulkOrInterruptTransfer.TransferBufferLength;
+
+        InterlockedExchangeAdd(&rwContext->BytesTransferred, (LONG) bytesReadWritten);
+
+        if (bytesReadWritten == stageContext->Length) {
+
+            if (SendBulkStage(Request)) {
+                return;
+            }
+        }
+        else {
+            //
+            // The device ended the transfer with a short packet. The stages
+            // after this one would receive the data of its next transfer.
+            //
+            end = (LONG) (stageContext->Offset + bytesReadWritten);
+
+            do {
+                shortEnd = rwContext->ShortEnd;
+            } while (end < shortEnd &&
+                     InterlockedCompareExchange(&rwContext->ShortEnd, end, shortEnd) != shortEnd);
+
+            StopBulkStages(rwContext, STATUS_SUCCESS);
+        }
+    }
+    else if (status == STATUS_CANCELLED &&
+             rwContext->ShortEnd < (LONG) rwContext->TotalLength) {
+        //
+        // Cancelled after a short packet.
+        //
+        NOTHING;
+    }
+    else {
+
+        UsbSamp_DbgPrint(1, ("Bulk stage at offset %d failed 0x%x\n",
+                             stageContext->Offset, status));
+
+        if (status != STATUS_CANCELLED &&
+            InterlockedExchange(&rwContext->ResetQueued, TRUE) == FALSE) {
+            //
+            // Queue a workitem to reset the pipe because the completion could be
+            // running at DISPATCH_LEVEL.
+            //
+            QueuePassiveLevelCallback(WdfIoTargetGetDevice(Target), rwContext->Pipe);
+        }
+
+        StopBulkStages(rwContext, status);
+    }
+
+    RetireBulkStage(request);
+
+    return;
+}
+
+VOID
+UsbSamp_EvtBulkTransferCancel(
+    _In_ WDFREQUEST Request
+    )
+/*++
+
+Routine Description:
+
+    This is the cancel routine for a bulk transfer with stages in flight.
+    It cancels the stages, and the request is completed once they have
+    all completed.
+
+Arguments:
+
+    Request - The user read or write request
+
+Return Value:
+    None
+
+--*/
+{
+    UsbSamp_DbgPrint(3, ("Bulk transfer cancelled\n"));
+
+    StopBulkStages(GetRequestContext(Request), STATUS_CANCELLED);
+
+    ReleaseBulkTransfer(Request);
+
+    return;
+}
+
+VOID
+StopBulkStages(
+    _In_ PREQUEST_CONTEXT rwContext,
+    _In_ NTSTATUS         Status
+    )
+/*++
+
+Routine Description:
+
+    This routine stops a bulk transfer from sending more stages and
+    cancels the stages in flight. The first failure status is the status
+    the request completes with.
+
+Arguments:
+
+    rwContext - Context of the user request
+
+    Status - Status of the failure, or STATUS_SUCCESS
+
+Return Value:
+    None
+
+--*/
+{
+    ULONG i;
+
+    InterlockedCompareExchange((LONG volatile *) &rwContext->Status, Status, STATUS_SUCCESS);
+
+    if (InterlockedExchange(&rwContext->Stopping, TRUE) == FALSE) {
+
+        for (i = 0; i < rwContext->NumStages; i++) {
+            WdfRequestCancelSentRequest(rwContext->Stages[i]);
+        }
+    }
+
+    return;
+}
+
+VOID
+RetireBulkStage(
+    _In_ WDFREQUEST Request
+    )
+/*++
+
+Routine Description:
+
+    This routine is called when a stage won't be sent again. Once the last
+    stage is retired, the request is no longer cancelable.
+
+Arguments:
+
+    Request - The user read or write request
+
+Return Value:
+    None
+
+--*/
+{
+    PREQUEST_CONTEXT rwContext = GetRequestContext(Request);
+
+    if (InterlockedDecrement(&rwContext->StagesActive) == 0) {
+
+        //
+        // If the request was cancelled, the cancel routine releases its
+        // own reference.
+        //
+        if (NT_SUCCESS(WdfRequestUnmarkCancelable(Request))) {
+            ReleaseBulkTransfer(Request);
+        }
+
+        ReleaseBulkTransfer(Request);
+    }
+
+    return;
+}
+
+VOID
+ReleaseBulkTransfer(
+    _In_ WDFREQUEST Request
+    )
+/*++
+
+Routine Description:
+
+    This routine releases a reference on a bulk transfer with stages in
+    flight. The last reference frees the stages and completes the request.
+
+Arguments:
+
+    Request - The user read or write request
+
+Return Value:
+    None
+
+--*/
+{
+    PREQUEST_CONTEXT        rwContext = GetRequestContext(Request);
+    PBULK_STAGE_CONTEXT     stageContext;
+    NTSTATUS                status;
+    ULONG_PTR               information = 0;
+    ULONG                   i;
+
+    if (InterlockedDecrement(&rwContext->References) != 0) {
+        return;
+    }
+
+    for (i = 0; i < rwContext->NumStages; i++) {
+
+        stageContext = GetBulkStageContext(rwContext->Stages[i]);
+
+        if (stageContext->Mdl != NULL) {
+            IoFreeMdl(stageContext->Mdl);
+        }
+
+        WdfObjectDelete(rwContext->Stages[i]);
+    }
+
+    rwContext->NumStages = 0;
+
+    status = rwContext->Status;
+
+    if (NT_SUCCESS(status)) {
+
+        if (rwContext->ShortEnd < (LONG) rwContext->TotalLength) {
+            information = (ULONG_PTR) rwContext->ShortEnd;
+        }
+        else {
+            information = (ULONG_PTR) rwContext->BytesTransferred;
+        }
+    }
+
+    UsbSamp_DbgPrint(3, ("%s request completed with status 0x%x, %d bytes\n",
+                         rwContext->Read ? "Read" : "Write", status, (ULONG) information));
+
+    ReleaseStreamForRequest(Request);
+
+    WdfRequestCompleteWithInformation(Request, status, information);
+
+    return;
+}
+
 #else
 
 VOID
@@ -614,6 +1199,7 @@ Return Value:
 
 Exit:
     if (!NT_SUCCESS(status)) {
+        ReleaseStreamForRequest(Request);
         WdfRequestCompleteWithInformation(Request, status, 0);
     }
 
@@ -796,6 +1382,8 @@ End:
     UsbSamp_DbgPrint(3, ("%s request completed with status 0x%x\n",
                                                     operation, status));
 
+    ReleaseStreamForRequest(Request);
+
     WdfRequestComplete(Request, status);
 
     return;
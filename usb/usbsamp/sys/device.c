@@ -81,6 +81,8 @@ Return Value:
     WDFQUEUE                            queue;
     ULONG                               maximumTransferSize;
 
+    ULONG                               bulkStagesInFlight;
+
     UNREFERENCED_PARAMETER(Driver);
 
     UsbSamp_DbgPrint (3, ("UsbSamp_EvtDeviceAdd routine\n"));
@@ -187,6 +189,22 @@ Return Value:
         pDevContext->MaximumTransferSize = DEFAULT_REGISTRY_TRANSFER_SIZE;
     }
 
+    //
+    //Get BulkStagesInFlight from registry
+    //
+    bulkStagesInFlight = 0;
+
+    ReadFdoRegistryKeyValue(Driver,
+                              L"BulkStagesInFlight",
+                              &bulkStagesInFlight);
+
+    if (bulkStagesInFlight){
+        pDevContext->BulkStagesInFlight = (LONG) min(bulkStagesInFlight, MAX_BULK_STAGES_IN_FLIGHT);
+    }
+    else {
+        pDevContext->BulkStagesInFlight = DEFAULT_REGISTRY_BULK_STAGES;
+    }
+
     //
     // Tell the framework to set the SurpriseRemovalOK in the DeviceCaps so
     // that you don't get the popup in usermode (on Win2K) when you surprise
@@ -1669,6 +1687,10 @@ Return Value:
         ExFreePool(pStreamInfo->StreamList);
         pStreamInfo->StreamList = NULL;
     }
+    if(pStreamInfo->StreamLoad != NULL){
+        ExFreePool((PVOID) pStreamInfo->StreamLoad);
+        pStreamInfo->StreamLoad = NULL;
+    }
 
 }
 #endif
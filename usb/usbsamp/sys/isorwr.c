@@ -527,6 +527,689 @@ Return Value:
     return;
 }
 
+NTSTATUS
+StartIsochRing(
+    _In_ PDEVICE_CONTEXT  DeviceContext,
+    _In_ WDFREQUEST       Request
+    )
+/*++
+
+Routine Description:
+
+    This routine starts an isoch ring on the isochronous IN pipe of the
+    request's handle.
+
+    Instead of one URB per read request, the ring keeps NumberOfUrbs URBs
+    scheduled with USBD_START_ISO_TRANSFER_ASAP, so the host controller
+    chains each one right after the previous one. When an URB completes,
+    its packets are copied into the ring in the output buffer of the
+    request, and the URB is scheduled again behind the others. The request
+    stays pending until it is cancelled or the pipe fails.
+
+    Packets that failed, and frames that passed between two URBs because
+    an URB was scheduled too late, are counted as missed in the ring
+    header.
+
+Arguments:
+
+    DeviceContext - Device context
+
+    Request - The IOCTL_USBSAMP_START_ISOCH_RING request
+
+Return Value:
+
+    STATUS_PENDING if the ring runs and owns the request. Otherwise the
+    caller completes the request with the status returned.
+
+--*/
+{
+    PFILE_CONTEXT                   fileContext;
+    WDFUSBPIPE                      pipe;
+    PPIPE_CONTEXT                   pipeContext;
+    WDF_USB_PIPE_INFORMATION        pipeInfo;
+    PUSBSAMP_ISOCH_RING_PARAMETERS  params;
+    PISOCH_RING_CONTEXT             ring = NULL;
+    PISOCH_RING_URB_CONTEXT         urbContext;
+    WDF_OBJECT_ATTRIBUTES           attributes;
+    WDFREQUEST                      urbRequest;
+    WDFMEMORY                       bufferMemory;
+    PMDL                            ringMdl;
+    PUCHAR                          ringAddress;
+    ULONG                           ringLength;
+    ULONG                           maxPackets;
+    size_t                          bufLength;
+    NTSTATUS                        status;
+    ULONG                           i;
+
+    fileContext = GetFileContext(WdfRequestGetFileObject(Request));
+    pipe = fileContext->Pipe;
+
+    if (pipe == NULL) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    WDF_USB_PIPE_INFORMATION_INIT(&pipeInfo);
+    WdfUsbTargetPipeGetInformation(pipe, &pipeInfo);
+
+    if (WdfUsbPipeTypeIsochronous != pipeInfo.PipeType ||
+        WdfUsbTargetPipeIsInEndpoint(pipe) == FALSE) {
+        UsbSamp_DbgPrint(1, ("Isoch ring needs an isochronous IN pipe\n"));
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
+    pipeContext = GetPipeContext(pipe);
+
+    if (InterlockedCompareExchange(&pipeContext->IsochRingActive, TRUE, FALSE) != FALSE) {
+        UsbSamp_DbgPrint(1, ("An isoch ring already runs on the pipe\n"));
+        return STATUS_DEVICE_BUSY;
+    }
+
+    status = WdfRequestRetrieveInputBuffer(Request,
+                                           sizeof(USBSAMP_ISOCH_RING_PARAMETERS),
+                                           (PVOID*) &params,
+                                           &bufLength);
+    if (!NT_SUCCESS(status)) {
+        UsbSamp_DbgPrint(1, ("WdfRequestRetrieveInputBuffer failed\n"));
+        goto Exit;
+    }
+
+    if (params->NumberOfUrbs < 2 ||
+        params->NumberOfUrbs > USBSAMP_MAX_ISOCH_RING_URBS) {
+        UsbSamp_DbgPrint(1, ("Isoch ring needs 2 to %d URBs\n", USBSAMP_MAX_ISOCH_RING_URBS));
+        status = STATUS_INVALID_PARAMETER;
+        goto Exit;
+    }
+
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, ISOCH_RING_CONTEXT);
+
+    status = WdfObjectAllocateContext(Request, &attributes, (PVOID*) &ring);
+    if (!NT_SUCCESS(status)) {
+        UsbSamp_DbgPrint(1, ("WdfObjectAllocateContext failed 0x%x\n", status));
+        ring = NULL;
+        goto Exit;
+    }
+
+    ring->Pipe = pipe;
+    ring->Status = STATUS_SUCCESS;
+    ring->FramesPerUrb = params->FramesPerUrb ? params->FramesPerUrb : DEFAULT_ISOCH_RING_FRAMES_PER_URB;
+
+    //
+    // Packets are as large as in PerformIsochTransfer: one per frame on a
+    // full speed device, one per interval on the others.
+    //
+    if (DeviceContext->IsDeviceSuperSpeed || DeviceContext->IsDeviceHighSpeed) {
+        ring->PacketSize = pipeContext->TransferSizePerMicroframe;
+        ring->PacketsPerFrame = pipeContext->TransferSizePerFrame / pipeContext->TransferSizePerMicroframe;
+        maxPackets = DeviceContext->IsDeviceSuperSpeed ?
+                        MAX_SUPPORTED_PACKETS_FOR_SUPER_SPEED : MAX_SUPPORTED_PACKETS_FOR_HIGH_SPEED;
+    }
+    else {
+        ring->PacketSize = pipeContext->TransferSizePerFrame;
+        ring->PacketsPerFrame = 1;
+        maxPackets = MAX_SUPPORTED_PACKETS_FOR_FULL_SPEED;
+    }
+
+    if (ring->FramesPerUrb > maxPackets / ring->PacketsPerFrame) {
+        UsbSamp_DbgPrint(1, ("Isoch ring URBs can cover at most %d frames\n",
+                             maxPackets / ring->PacketsPerFrame));
+        status = STATUS_INVALID_PARAMETER;
+        goto Exit;
+    }
+
+    ring->PacketsPerUrb = ring->FramesPerUrb * ring->PacketsPerFrame;
+
+    //
+    // The ring must hold at least what one URB can receive.
+    //
+    status = WdfRequestRetrieveOutputWdmMdl(Request, &ringMdl);
+    if (!NT_SUCCESS(status)) {
+        UsbSamp_DbgPrint(1, ("WdfRequestRetrieveOutputWdmMdl failed %x\n", status));
+        goto Exit;
+    }
+
+    ringLength = MmGetMdlByteCount(ringMdl);
+
+    if (ringLength < sizeof(USBSAMP_ISOCH_RING_HEADER) + ring->PacketsPerUrb * ring->PacketSize) {
+        UsbSamp_DbgPrint(1, ("Isoch ring of %d bytes is too small\n", ringLength));
+        status = STATUS_BUFFER_TOO_SMALL;
+        goto Exit;
+    }
+
+    ringAddress = MmGetSystemAddressForMdlSafe(ringMdl, NormalPagePriority);
+    if (ringAddress == NULL) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Exit;
+    }
+
+    ring->Header = (PUSBSAMP_ISOCH_RING_HEADER) ringAddress;
+    ring->Data = ringAddress + sizeof(USBSAMP_ISOCH_RING_HEADER);
+    ring->DataSize = ringLength - sizeof(USBSAMP_ISOCH_RING_HEADER);
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject = Request;
+
+    status = WdfSpinLockCreate(&attributes, &ring->Lock);
+    if (!NT_SUCCESS(status)) {
+        UsbSamp_DbgPrint(1, ("WdfSpinLockCreate failed 0x%x\n", status));
+        goto Exit;
+    }
+
+    for (i = 0; i < params->NumberOfUrbs; i++) {
+
+        WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, ISOCH_RING_URB_CONTEXT);
+        attributes.ParentObject = Request;
+
+        status = WdfRequestCreate(&attributes,
+                                  WdfUsbTargetPipeGetIoTarget(pipe),
+                                  &urbRequest);
+        if (!NT_SUCCESS(status)) {
+            UsbSamp_DbgPrint(1, ("WdfRequestCreate for isoch ring failed 0x%x\n", status));
+            goto Exit;
+        }
+
+        ring->Urbs[ring->NumUrbs++] = urbRequest;
+
+        urbContext = GetIsochRingUrbContext(urbRequest);
+        urbContext->RingRequest = Request;
+
+        WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+        attributes.ParentObject = urbRequest;
+
+        status = WdfUsbTargetDeviceCreateIsochUrb(DeviceContext->WdfUsbTargetDevice,
+                                                  &attributes,
+                                                  ring->PacketsPerUrb,
+                                                  &urbContext->UrbMemory,
+                                                  NULL);
+        if (!NT_SUCCESS(status)) {
+            UsbSamp_DbgPrint(1, ("WdfUsbTargetDeviceCreateIsochUrb failed 0x%x\n", status));
+            goto Exit;
+        }
+
+        status = WdfMemoryCreate(&attributes,
+                                 NonPagedPool,
+                                 POOL_TAG,
+                                 ring->PacketsPerUrb * ring->PacketSize,
+                                 &bufferMemory,
+                                 (PVOID*) &urbContext->Buffer);
+        if (!NT_SUCCESS(status)) {
+            UsbSamp_DbgPrint(1, ("WdfMemoryCreate failed 0x%x\n", status));
+            goto Exit;
+        }
+    }
+
+    RtlZeroMemory(ring->Header, sizeof(USBSAMP_ISOCH_RING_HEADER));
+    ring->Header->HeaderSize = sizeof(USBSAMP_ISOCH_RING_HEADER);
+    ring->Header->DataSize = ring->DataSize;
+    ring->Header->PacketSize = ring->PacketSize;
+
+    //
+    // One reference for the URBs and one for the cancel routine, which
+    // can run as soon as the request is cancelable.
+    //
+    ring->UrbsActive = (LONG) ring->NumUrbs;
+    ring->References = 2;
+
+    status = WdfRequestMarkCancelableEx(Request, UsbSamp_EvtIsochRingCancel);
+    if (!NT_SUCCESS(status)) {
+        goto Exit;
+    }
+
+    UsbSamp_DbgPrint(3, ("Isoch ring of %d bytes, %d URBs of %d packets of %d bytes\n",
+                         ring->DataSize, ring->NumUrbs, ring->PacketsPerUrb, ring->PacketSize));
+
+    for (i = 0; i < ring->NumUrbs; i++) {
+
+        if (!SendIsochRingUrb(ring->Urbs[i])) {
+            RetireIsochRingUrb(Request);
+        }
+    }
+
+    return STATUS_PENDING;
+
+Exit:
+    if (ring != NULL) {
+
+        for (i = 0; i < ring->NumUrbs; i++) {
+            WdfObjectDelete(ring->Urbs[i]);
+        }
+
+        ring->NumUrbs = 0;
+    }
+
+    InterlockedExchange(&pipeContext->IsochRingActive, FALSE);
+
+    return status;
+}
+
+BOOLEAN
+SendIsochRingUrb(
+    _In_ WDFREQUEST Urb
+    )
+/*++
+
+Routine Description:
+
+    This routine schedules an URB of an isoch ring as soon as possible
+    after the URBs already scheduled on the pipe.
+
+Arguments:
+
+    Urb - The request that carries the URB
+
+Return Value:
+
+    TRUE if the URB was sent. If not, the caller retires the URB.
+
+--*/
+{
+    PISOCH_RING_URB_CONTEXT     urbContext;
+    PISOCH_RING_CONTEXT         ring;
+    WDFREQUEST                  request;
+    WDF_REQUEST_REUSE_PARAMS    reuseParams;
+    PURB                        urb;
+    NTSTATUS                    status;
+    ULONG                       j;
+
+    urbContext = GetIsochRingUrbContext(Urb);
+    request = urbContext->RingRequest;
+    ring = GetIsochRingContext(request);
+
+    if (ring->Stopping) {
+        return FALSE;
+    }
+
+    WDF_REQUEST_REUSE_PARAMS_INIT(&reuseParams, WDF_REQUEST_REUSE_NO_FLAGS, STATUS_SUCCESS);
+    status = WdfRequestReuse(Urb, &reuseParams);
+    if (!NT_SUCCESS(status)) {
+        UsbSamp_DbgPrint(1, ("WdfRequestReuse failed %x\n", status));
+        goto Error;
+    }
+
+    urb = WdfMemoryGetBuffer(urbContext->UrbMemory, NULL);
+
+    urb->UrbIsochronousTransfer.Hdr.Length = (USHORT) GET_ISO_URB_SIZE(ring->PacketsPerUrb);
+    urb->UrbIsochronousTransfer.Hdr.Function = URB_FUNCTION_ISOCH_TRANSFER;
+    urb->UrbIsochronousTransfer.PipeHandle = WdfUsbTargetPipeWdmGetPipeHandle(ring->Pipe);
+    urb->UrbIsochronousTransfer.TransferFlags = USBD_TRANSFER_DIRECTION_IN |
+                                                USBD_START_ISO_TRANSFER_ASAP;
+    urb->UrbIsochronousTransfer.TransferBufferLength = ring->PacketsPerUrb * ring->PacketSize;
+    urb->UrbIsochronousTransfer.TransferBuffer = urbContext->Buffer;
+    urb->UrbIsochronousTransfer.TransferBufferMDL = NULL;
+    urb->UrbIsochronousTransfer.NumberOfPackets = ring->PacketsPerUrb;
+    urb->UrbIsochronousTransfer.StartFrame = 0;
+    urb->UrbIsochronousTransfer.UrbLink = NULL;
+
+    for (j = 0; j < ring->PacketsPerUrb; j++) {
+        urb->UrbIsochronousTransfer.IsoPacket[j].Offset = j * ring->PacketSize;
+        urb->UrbIsochronousTransfer.IsoPacket[j].Length = 0;
+        urb->UrbIsochronousTransfer.IsoPacket[j].Status = 0;
+    }
+
+    status = WdfUsbTargetPipeFormatRequestForUrb(ring->Pipe,
+                                                 Urb,
+                                                 urbContext->UrbMemory,
+                                                 NULL);
+    if (!NT_SUCCESS(status)) {
+        UsbSamp_DbgPrint(1, ("Failed to format requset for urb\n"));
+        goto Error;
+    }
+
+    WdfRequestSetCompletionRoutine(Urb, UsbSamp_EvtIsochRingCompletion, NULL);
+
+    //
+    // The URB can complete, and the ring with it, before WdfRequestSend
+    // returns. Keep both requests until this routine is done with them.
+    //
+    WdfObjectReference(request);
+    WdfObjectReference(Urb);
+
+    if (!WdfRequestSend(Urb, WdfUsbTargetPipeGetIoTarget(ring->Pipe), WDF_NO_SEND_OPTIONS)) {
+
+        status = WdfRequestGetStatus(Urb);
+        WdfObjectDereference(Urb);
+        WdfObjectDereference(request);
+        UsbSamp_DbgPrint(1, ("WdfRequestSend for isoch ring failed 0x%x\n", status));
+        goto Error;
+    }
+
+    //
+    // If the ring was stopped while this URB was being formatted,
+    // StopIsochRing had nothing to cancel for it.
+    //
+    if (ring->Stopping) {
+        WdfRequestCancelSentRequest(Urb);
+    }
+
+    WdfObjectDereference(Urb);
+    WdfObjectDereference(request);
+
+    return TRUE;
+
+Error:
+    StopIsochRing(ring, status);
+
+    return FALSE;
+}
+
+VOID
+UsbSamp_EvtIsochRingCompletion(
+    _In_ WDFREQUEST                  Request,
+    _In_ WDFIOTARGET                 Target,
+    PWDF_REQUEST_COMPLETION_PARAMS CompletionParams,
+    _In_ WDFCONTEXT                  Context
+    )
+/*++
+
+Routine Description:
+
+    This is the completion routine for an URB of an isoch ring. The
+    packets are copied into the ring, and the URB is scheduled again.
+
+Arguments:
+
+    Request - The request that carries the URB
+
+    Target - The pipe I/O target
+
+    CompletionParams - Request completion params
+
+    Context - Unused
+
+Return Value:
+    None
+
+--*/
+{
+    PISOCH_RING_URB_CONTEXT     urbContext;
+    PISOCH_RING_CONTEXT         ring;
+    WDFREQUEST                  request;
+    NTSTATUS                    status;
+    PURB                        urb;
+
+    UNREFERENCED_PARAMETER(Target);
+    UNREFERENCED_PARAMETER(Context);
+
+    urbContext = GetIsochRingUrbContext(Request);
+    request = urbContext->RingRequest;
+    ring = GetIsochRingContext(request);
+
+    status = CompletionParams->IoStatus.Status;
+
+    if (NT_SUCCESS(status)) {
+
+        urb = WdfMemoryGetBuffer(urbContext->UrbMemory, NULL);
+
+        CopyIsochRingPackets(ring, urb, urbContext->Buffer);
+
+        if (SendIsochRingUrb(Request)) {
+            return;
+        }
+    }
+    else if (status != STATUS_CANCELLED || !ring->Stopping) {
+
+        urb = WdfMemoryGetBuffer(urbContext->UrbMemory, NULL);
+
+        UsbSamp_DbgPrint(1, ("Isoch ring URB failed with NTSTATUS 0x%x, USBD_STATUS 0x%x\n",
+                             status, urb->UrbHeader.Status));
+
+        StopIsochRing(ring, status);
+    }
+
+    RetireIsochRingUrb(request);
+
+    return;
+}
+
+VOID
+CopyIsochRingPackets(
+    _In_ PISOCH_RING_CONTEXT    Ring,
+    _In_ PURB                   Urb,
+    _In_ PUCHAR                 Buffer
+    )
+/*++
+
+Routine Description:
+
+    This routine copies the packets of a completed URB into the ring and
+    updates the ring header.
+
+Arguments:
+
+    Ring - Isoch ring context
+
+    Urb - The completed URB
+
+    Buffer - The buffer of the URB
+
+Return Value:
+    None
+
+--*/
+{
+    PUSBD_ISO_PACKET_DESCRIPTOR packet;
+    ULONG                       startFrame;
+    ULONG                       bytes = 0;
+    ULONG                       received = 0;
+    ULONG                       missed = 0;
+    ULONG                       length;
+    ULONG                       chunk;
+    PUCHAR                      source;
+    ULONG                       i;
+
+    WdfSpinLockAcquire(Ring->Lock);
+
+    //
+    // The stack returns the frame the URB started at. If that is past the
+    // end of the previous URB, the frames in between weren't scheduled.
+    //
+    startFrame = Urb->UrbIsochronousTransfer.StartFrame;
+
+    if (Ring->NextStartFrameValid &&
+        (LONG) (startFrame - Ring->NextStartFrame) > 0) {
+        missed += (startFrame - Ring->NextStartFrame) * Ring->PacketsPerFrame;
+    }
+
+    Ring->NextStartFrame = startFrame + Ring->FramesPerUrb;
+    Ring->NextStartFrameValid = TRUE;
+
+    for (i = 0; i < Urb->UrbIsochronousTransfer.NumberOfPackets; i++) {
+
+        packet = &Urb->UrbIsochronousTransfer.IsoPacket[i];
+
+        if (!USBD_SUCCESS(packet->Status)) {
+            missed++;
+            continue;
+        }
+
+        received++;
+
+        source = Buffer + packet->Offset;
+        length = min(packet->Length, Ring->PacketSize);
+        bytes += length;
+
+        while (length != 0) {
+
+            chunk = min(length, Ring->DataSize - Ring->WriteOffset);
+            RtlCopyMemory(Ring->Data + Ring->WriteOffset, source, chunk);
+
+            Ring->WriteOffset = (Ring->WriteOffset + chunk) % Ring->DataSize;
+            source += chunk;
+            length -= chunk;
+        }
+    }
+
+    Ring->Header->PacketsReceived += received;
+    Ring->Header->PacketsMissed += missed;
+
+    //
+    // The data has to be in the ring before the app sees it counted.
+    //
+    KeMemoryBarrier();
+
+    Ring->Header->BytesWritten += bytes;
+
+    WdfSpinLockRelease(Ring->Lock);
+
+    if (missed != 0) {
+        UsbSamp_DbgPrint(2, ("Isoch ring missed %d packets at frame %d\n", missed, startFrame));
+    }
+
+    return;
+}
+
+VOID
+UsbSamp_EvtIsochRingCancel(
+    _In_ WDFREQUEST Request
+    )
+/*++
+
+Routine Description:
+
+    This is the cancel routine of an isoch ring. It cancels the URBs,
+    and the request is completed once they have all completed.
+
+Arguments:
+
+    Request - The IOCTL_USBSAMP_START_ISOCH_RING request
+
+Return Value:
+    None
+
+--*/
+{
+    UsbSamp_DbgPrint(3, ("Isoch ring cancelled\n"));
+
+    StopIsochRing(GetIsochRingContext(Request), STATUS_CANCELLED);
+
+    ReleaseIsochRing(Request);
+
+    return;
+}
+
+VOID
+StopIsochRing(
+    _In_ PISOCH_RING_CONTEXT Ring,
+    _In_ NTSTATUS            Status
+    )
+/*++
+
+Routine Description:
+
+    This routine stops an isoch ring from scheduling more URBs and cancels
+    the URBs scheduled. The first status is the status the request
+    completes with.
+
+Arguments:
+
+    Ring - Isoch ring context
+
+    Status - Why the ring stops
+
+Return Value:
+    None
+
+--*/
+{
+    ULONG i;
+
+    InterlockedCompareExchange((LONG volatile *) &Ring->Status, Status, STATUS_SUCCESS);
+
+    if (InterlockedExchange(&Ring->Stopping, TRUE) == FALSE) {
+
+        for (i = 0; i < Ring->NumUrbs; i++) {
+            WdfRequestCancelSentRequest(Ring->Urbs[i]);
+        }
+    }
+
+    return;
+}
+
+VOID
+RetireIsochRingUrb(
+    _In_ WDFREQUEST Request
+    )
+/*++
+
+Routine Description:
+
+    This routine is called when an URB of an isoch ring won't be scheduled
+    again. Once the last URB is retired, the request is no longer
+    cancelable.
+
+Arguments:
+
+    Request - The IOCTL_USBSAMP_START_ISOCH_RING request
+
+Return Value:
+    None
+
+--*/
+{
+    PISOCH_RING_CONTEXT ring = GetIsochRingContext(Request);
+
+    if (InterlockedDecrement(&ring->UrbsActive) == 0) {
+
+        //
+        // If the request was cancelled, the cancel routine releases its
+        // own reference.
+        //
+        if (NT_SUCCESS(WdfRequestUnmarkCancelable(Request))) {
+            ReleaseIsochRing(Request);
+        }
+
+        ReleaseIsochRing(Request);
+    }
+
+    return;
+}
+
+VOID
+ReleaseIsochRing(
+    _In_ WDFREQUEST Request
+    )
+/*++
+
+Routine Description:
+
+    This routine releases a reference on an isoch ring. The last reference
+    frees the URBs and completes the request.
+
+Arguments:
+
+    Request - The IOCTL_USBSAMP_START_ISOCH_RING request
+
+Return Value:
+    None
+
+--*/
+{
+    PISOCH_RING_CONTEXT ring = GetIsochRingContext(Request);
+    NTSTATUS            status;
+    ULONG               i;
+
+    if (InterlockedDecrement(&ring->References) != 0) {
+        return;
+    }
+
+    for (i = 0; i < ring->NumUrbs; i++) {
+        WdfObjectDelete(ring->Urbs[i]);
+    }
+
+    ring->NumUrbs = 0;
+
+    status = ring->Status;
+    ring->Header->Status = status;
+
+    UsbSamp_DbgPrint(3, ("Isoch ring stopped with status 0x%x after %I64u bytes, %I64u packets missed\n",
+                         status, ring->Header->BytesWritten, ring->Header->PacketsMissed));
+
+    InterlockedExchange(&GetPipeContext(ring->Pipe)->IsochRingActive, FALSE);
+
+    WdfRequestCompleteWithInformation(Request, status, sizeof(USBSAMP_ISOCH_RING_HEADER));
+
+    return;
+}
+
 VOID
 UsbSamp_EvtIoStop(
     _In_ WDFQUEUE         Queue,
@@ -552,8 +1235,21 @@ Return Value:
 
 --*/
 {
+    PISOCH_RING_CONTEXT ring;
+
     UNREFERENCED_PARAMETER(Queue);
 
+    //
+    // An isoch ring is held by the driver, not sent to the target. Its
+    // URBs are.
+    //
+    ring = GetIsochRingContext(Request);
+
+    if (ring != NULL && (ActionFlags & WdfRequestStopActionPurge)) {
+        StopIsochRing(ring, STATUS_CANCELLED);
+        return;
+    }
+
     if (ActionFlags & WdfRequestStopActionSuspend ) {
         WdfRequestStopAcknowledge(Request, FALSE); // Don't requeue
     } 
@@ -78,6 +78,18 @@ Environment:
 
 #define DEFAULT_REGISTRY_TRANSFER_SIZE 65536
 
+//
+// Number of stages of a bulk transfer kept in flight at a time. 1 sends the
+// stages one after the other.
+//
+#define DEFAULT_REGISTRY_BULK_STAGES   1
+#define MAX_BULK_STAGES_IN_FLIGHT      8
+
+//
+// Frames each URB of an isoch ring covers when the app doesn't say.
+//
+#define DEFAULT_ISOCH_RING_FRAMES_PER_URB 8
+
 #define IDLE_CAPS_TYPE IdleUsbSelectiveSuspend
 
 
@@ -108,6 +120,8 @@ typedef struct _DEVICE_CONTEXT {
 
     ULONG                           MaximumTransferSize;
 
+    LONG                            BulkStagesInFlight;
+
     WDFQUEUE                        IsochReadQueue;
     
     WDFQUEUE                        IsochWriteQueue;
@@ -143,6 +157,12 @@ typedef struct _USBSAMP_STREAM_INFO {
     // Array of stream information structures representing streams on this pipe
     PUSBD_STREAM_INFORMATION StreamList;
 
+    // Number of requests in flight on each stream
+    LONG volatile *StreamLoad;
+
+    // Stream the scheduler starts looking from, to spread ties
+    LONG volatile NextStream;
+
 } USBSAMP_STREAM_INFO, *PUSBSAMP_STREAM_INFO;
 
 #endif
@@ -161,6 +181,8 @@ typedef struct _PIPE_CONTEXT {
 
     BOOLEAN  StreamConfigured;
 
+    LONG volatile IsochRingActive; // an isoch ring runs on the pipe
+
 #if (NTDDI_VERSION >= NTDDI_WIN8)
     USBSAMP_STREAM_INFO    StreamInfo;
 #endif
@@ -183,10 +205,90 @@ typedef struct _REQUEST_CONTEXT {
     ULONG             Numxfer;
     ULONG_PTR         VirtualAddress; // va for next segment of xfer.
     BOOLEAN           Read; // TRUE if Read
+    ULONG             StreamId; // stream the request is scheduled on, 0 if none
+
+    //
+    // Used by bulk transfers that keep several stages in flight.
+    //
+    WDFUSBPIPE        Pipe;
+    USBD_PIPE_HANDLE  UsbdPipeHandle;
+    PMDL              RequestMdl;
+    ULONG             UrbFlags;
+    ULONG             TotalLength;
+    ULONG             StageLength;
+    ULONG             NumStages;
+    WDFREQUEST        Stages[MAX_BULK_STAGES_IN_FLIGHT];
+    LONG volatile     NextOffset;       // offset of the next stage to send
+    LONG volatile     BytesTransferred;
+    LONG volatile     ShortEnd;         // end of the data if a stage came back short
+    LONG volatile     StagesActive;
+    LONG volatile     References;       // the stages and the cancel routine
+    LONG volatile     Stopping;         // no more stages are sent
+    LONG volatile     ResetQueued;
+    NTSTATUS volatile Status;
 } REQUEST_CONTEXT, * PREQUEST_CONTEXT;
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(REQUEST_CONTEXT, GetRequestContext)
 
+//
+// This context is associated with every driver created request that
+// carries a stage of a bulk transfer.
+//
+typedef struct _BULK_STAGE_CONTEXT {
+
+    WDFREQUEST        MainRequest;
+    WDFMEMORY         UrbMemory;
+    PMDL              Mdl;
+    ULONG             Offset;           // of the stage in the transfer
+    ULONG             Length;
+
+} BULK_STAGE_CONTEXT, *PBULK_STAGE_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(BULK_STAGE_CONTEXT, GetBulkStageContext)
+
+//
+// This context is added to an IOCTL_USBSAMP_START_ISOCH_RING request while
+// the ring runs.
+//
+typedef struct _ISOCH_RING_CONTEXT {
+
+    WDFUSBPIPE        Pipe;
+    WDFSPINLOCK       Lock;             // serializes writes to the ring
+    PUSBSAMP_ISOCH_RING_HEADER Header;  // system address of the user ring
+    PUCHAR            Data;
+    ULONG             DataSize;
+    ULONG             WriteOffset;
+    ULONG             PacketSize;
+    ULONG             PacketsPerFrame;
+    ULONG             FramesPerUrb;
+    ULONG             PacketsPerUrb;
+    ULONG             NextStartFrame;   // frame the next URB should start at
+    BOOLEAN           NextStartFrameValid;
+    ULONG             NumUrbs;
+    WDFREQUEST        Urbs[USBSAMP_MAX_ISOCH_RING_URBS];
+    LONG volatile     UrbsActive;
+    LONG volatile     References;       // the URBs and the cancel routine
+    LONG volatile     Stopping;
+    NTSTATUS volatile Status;
+
+} ISOCH_RING_CONTEXT, *PISOCH_RING_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(ISOCH_RING_CONTEXT, GetIsochRingContext)
+
+//
+// This context is associated with every driver created request that
+// carries an URB of an isoch ring.
+//
+typedef struct _ISOCH_RING_URB_CONTEXT {
+
+    WDFREQUEST        RingRequest;
+    WDFMEMORY         UrbMemory;
+    PUCHAR            Buffer;
+
+} ISOCH_RING_URB_CONTEXT, *PISOCH_RING_URB_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(ISOCH_RING_URB_CONTEXT, GetIsochRingUrbContext)
+
 typedef struct _WORKITEM_CONTEXT {
     WDFDEVICE       Device;
     WDFUSBPIPE      Pipe;
@@ -214,6 +316,12 @@ EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL UsbSamp_EvtIoDeviceControl;
 
 EVT_WDF_REQUEST_COMPLETION_ROUTINE UsbSamp_EvtReadWriteCompletion;
 EVT_WDF_REQUEST_COMPLETION_ROUTINE UsbSamp_EvtIsoRequestCompletionRoutine;
+EVT_WDF_REQUEST_COMPLETION_ROUTINE UsbSamp_EvtBulkStageCompletion;
+
+EVT_WDF_REQUEST_COMPLETION_ROUTINE UsbSamp_EvtIsochRingCompletion;
+
+EVT_WDF_REQUEST_CANCEL UsbSamp_EvtBulkTransferCancel;
+EVT_WDF_REQUEST_CANCEL UsbSamp_EvtIsochRingCancel;
 
 EVT_WDF_IO_QUEUE_IO_STOP UsbSamp_EvtIoStop;
 
@@ -243,6 +351,40 @@ ReadWriteBulkEndPoints(
     _In_ WDF_REQUEST_TYPE RequestType
     );
 
+VOID
+StartBulkStages(
+    _In_ PDEVICE_CONTEXT  DeviceContext,
+    _In_ WDFREQUEST       Request,
+    _In_ WDFUSBPIPE       Pipe,
+    _In_ USBD_PIPE_HANDLE UsbdPipeHandle,
+    _In_ PMDL             RequestMdl,
+    _In_ ULONG            TotalLength,
+    _In_ ULONG            StageLength,
+    _In_ ULONG            UrbFlags,
+    _In_ ULONG            StagesInFlight
+    );
+
+BOOLEAN
+SendBulkStage(
+    _In_ WDFREQUEST Stage
+    );
+
+VOID
+StopBulkStages(
+    _In_ PREQUEST_CONTEXT rwContext,
+    _In_ NTSTATUS         Status
+    );
+
+VOID
+RetireBulkStage(
+    _In_ WDFREQUEST Request
+    );
+
+VOID
+ReleaseBulkTransfer(
+    _In_ WDFREQUEST Request
+    );
+
 NTSTATUS
 ResetPipe(
     _In_ WDFUSBPIPE             Pipe
@@ -292,6 +434,40 @@ PerformIsochTransfer(
     _In_ ULONG            TotalLength
     );
 
+NTSTATUS
+StartIsochRing(
+    _In_ PDEVICE_CONTEXT  DeviceContext,
+    _In_ WDFREQUEST       Request
+    );
+
+BOOLEAN
+SendIsochRingUrb(
+    _In_ WDFREQUEST Urb
+    );
+
+VOID
+StopIsochRing(
+    _In_ PISOCH_RING_CONTEXT Ring,
+    _In_ NTSTATUS            Status
+    );
+
+VOID
+CopyIsochRingPackets(
+    _In_ PISOCH_RING_CONTEXT    Ring,
+    _In_ PURB                   Urb,
+    _In_ PUCHAR                 Buffer
+    );
+
+VOID
+RetireIsochRingUrb(
+    _In_ WDFREQUEST Request
+    );
+
+VOID
+ReleaseIsochRing(
+    _In_ WDFREQUEST Request
+    );
+
 VOID
 DbgPrintRWContext(
     PREQUEST_CONTEXT                 rwContext
@@ -368,7 +544,8 @@ InitializePipeContextForSuperSpeedBulkPipe(
     );
 
 USBD_PIPE_HANDLE
-GetStreamPipeHandleFromBulkPipe(
+AcquireStreamForRequest(
+    _In_ WDFREQUEST Request,
     _In_ WDFUSBPIPE Pipe
     );
 
@@ -380,6 +557,11 @@ ConfigureStreamPipeHandleForRequest(
 
 #endif
 
+VOID
+ReleaseStreamForRequest(
+    _In_ WDFREQUEST Request
+    );
+
 ULONG
 GetMaxTransferSize(
     _In_ WDFUSBPIPE        Pipe, 
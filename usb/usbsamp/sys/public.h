@@ -46,4 +46,62 @@ DEFINE_GUID(GUID_CLASS_USBSAMP_USB,
                                                      METHOD_BUFFERED,         \
                                                      FILE_ANY_ACCESS)
 
+//
+// Input is a ULONG, the number of stages of a bulk transfer to keep in
+// flight, from 1 to 8. Overrides the BulkStagesInFlight registry value
+// until the device is restarted.
+//
+#define IOCTL_USBSAMP_SET_BULK_STAGES       CTL_CODE(FILE_DEVICE_UNKNOWN,     \
+                                                     IOCTL_INDEX + 3, \
+                                                     METHOD_BUFFERED,         \
+                                                     FILE_ANY_ACCESS)
+
+//
+// Sent on the handle of an isochronous IN pipe. The input is a
+// USBSAMP_ISOCH_RING_PARAMETERS. The output buffer is the ring: a
+// USBSAMP_ISOCH_RING_HEADER followed by the data. The driver keeps
+// NumberOfUrbs URBs scheduled back to back and copies the packets it
+// receives into the ring, overwriting the oldest data, until the request
+// is cancelled or the pipe fails. The request stays pending all that time.
+//
+#define IOCTL_USBSAMP_START_ISOCH_RING      CTL_CODE(FILE_DEVICE_UNKNOWN,     \
+                                                     IOCTL_INDEX + 4, \
+                                                     METHOD_OUT_DIRECT,       \
+                                                     FILE_ANY_ACCESS)
+
+#define USBSAMP_MAX_ISOCH_RING_URBS         8
+
+typedef struct _USBSAMP_ISOCH_RING_PARAMETERS {
+
+    //
+    // URBs kept scheduled, from 2 to USBSAMP_MAX_ISOCH_RING_URBS
+    //
+    ULONG NumberOfUrbs;
+
+    //
+    // Frames each URB covers, or 0 for the default
+    //
+    ULONG FramesPerUrb;
+
+} USBSAMP_ISOCH_RING_PARAMETERS, *PUSBSAMP_ISOCH_RING_PARAMETERS;
+
+//
+// Written by the driver while the ring runs. The data starts HeaderSize
+// bytes into the ring, and the next packet goes at offset
+// BytesWritten % DataSize of the data. BytesWritten is updated after the
+// data it counts, so a reader that is more than DataSize bytes behind it
+// has lost data.
+//
+typedef struct _USBSAMP_ISOCH_RING_HEADER {
+
+    ULONG HeaderSize;
+    ULONG DataSize;
+    ULONG PacketSize;
+    LONG  Status;               // status that stopped the ring, 0 while it runs
+    volatile ULONGLONG BytesWritten;
+    volatile ULONGLONG PacketsReceived;
+    volatile ULONGLONG PacketsMissed;   // packets that failed or weren't scheduled in time
+
+} USBSAMP_ISOCH_RING_HEADER, *PUSBSAMP_ISOCH_RING_HEADER;
+
 #endif
@@ -214,6 +214,37 @@ Return Value:
         status = ResetDevice(device);
         break;
 
+    case IOCTL_USBSAMP_SET_BULK_STAGES:
+
+        status = WdfRequestRetrieveInputBuffer(Request, sizeof(ULONG), &ioBuffer, &bufLength);
+        if (!NT_SUCCESS(status)){
+            UsbSamp_DbgPrint(1, ("WdfRequestRetrieveInputBuffer failed\n"));
+            break;
+        }
+
+        if (*(PULONG)ioBuffer == 0 ||
+            *(PULONG)ioBuffer > MAX_BULK_STAGES_IN_FLIGHT) {
+            status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        //
+        // Requests already in progress keep the depth they started with.
+        //
+        InterlockedExchange(&pDevContext->BulkStagesInFlight, *(PLONG)ioBuffer);
+        break;
+
+    case IOCTL_USBSAMP_START_ISOCH_RING:
+
+        status = StartIsochRing(pDevContext, Request);
+        if (status == STATUS_PENDING) {
+            //
+            // The ring completes the request when it stops.
+            //
+            return;
+        }
+        break;
+
     default :
         status = STATUS_INVALID_DEVICE_REQUEST;
         break;
@@ -143,6 +143,8 @@ Return Value:
     
     pStreamInfo->NumberOfStreams = 0;
     pStreamInfo->StreamList = NULL;
+    pStreamInfo->StreamLoad = NULL;
+    pStreamInfo->NextStream = 0;
  
     pipeContext->StreamConfigured = FALSE;
     
@@ -209,9 +211,20 @@ Return Value:
         goto End;
     }
 
+    pStreamInfo->StreamLoad = ExAllocatePoolWithTag(
+                                    NonPagedPool,
+                                    supportedStreams * sizeof(LONG),
+                                    POOL_TAG);
+
+    if (pStreamInfo->StreamLoad == NULL) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto End;
+    }
+
     for(i = 0; i < supportedStreams; i++)
     {
         pStreamInfo->StreamList[i].StreamID = i + 1;
+        pStreamInfo->StreamLoad[i] = 0;
     }
 
     status = USBD_UrbAllocate(DeviceContext->UsbdHandle, &pUrb);
@@ -253,6 +266,11 @@ End:
             pStreamInfo->StreamList = NULL;
         }
 
+        if (pStreamInfo->StreamLoad != NULL) {
+            ExFreePool((PVOID) pStreamInfo->StreamLoad);
+            pStreamInfo->StreamLoad = NULL;
+        }
+
     }
 
     if(pUrb != NULL) {
@@ -264,17 +282,29 @@ End:
 
 
 USBD_PIPE_HANDLE
-GetStreamPipeHandleFromBulkPipe(
+AcquireStreamForRequest(
+    _In_ WDFREQUEST                 Request,
     _In_ WDFUSBPIPE                 Pipe
     )
 /*++
 
 Routine Description:
 
-    This routine gets a stream USBD_PIPE_HANDLE from a super speed bulk pipe
+    This routine schedules a request on one of the streams of a super speed
+    bulk pipe, and gets the stream's USBD_PIPE_HANDLE.
+
+    The request goes to the stream with the fewest requests in flight, so
+    concurrent requests are spread across all the streams the pipe opened.
+    The search starts one stream further each time, so that streams with
+    the same load take turns. The request stays on its stream for all its
+    stages, and the stream is released by ReleaseStreamForRequest when the
+    request completes. Requests on different streams complete in whatever
+    order the device serves the streams.
 
 Arguments:
 
+    Request - Read/Write Request.
+
     Pipe - Bullk Pipe
 
 Return Value:
@@ -284,12 +314,26 @@ Return Value:
 --*/
 {
     PPIPE_CONTEXT               pipeContext;
-
+    PREQUEST_CONTEXT            rwContext;
     PUSBSAMP_STREAM_INFO        pStreamInfo;
     USBD_PIPE_HANDLE            streamPipeHandle;
     ULONG                       index;
+    ULONG                       start;
+    ULONG                       i;
+    ULONG                       candidate;
+    LONG                        load;
+    LONG                        minLoad;
 
     pipeContext = GetPipeContext(Pipe);
+    rwContext = GetRequestContext(Request);
+
+    //
+    // The request is already scheduled.
+    //
+    if (rwContext->StreamId != 0) {
+        streamPipeHandle = pipeContext->StreamInfo.StreamList[rwContext->StreamId - 1].PipeHandle;
+        goto End;
+    }
 
     if (pipeContext->StreamConfigured == FALSE) 
     {
@@ -300,16 +344,38 @@ Return Value:
     pStreamInfo = &pipeContext->StreamInfo;
 
     if (pStreamInfo->NumberOfStreams == 0 ||
-        pStreamInfo->StreamList == NULL)
+        pStreamInfo->StreamList == NULL ||
+        pStreamInfo->StreamLoad == NULL)
     {
          streamPipeHandle = NULL;
          goto End;
     }
 
     //
-    // Specify one associate stream's PipeHandle as the super speed bulk endpoint's PipeHandle
+    // Another request can take the same stream between the search and the
+    // increment. This only makes the load a little uneven.
     //
-    index = 1;
+    start = (ULONG) InterlockedIncrement(&pStreamInfo->NextStream) % pStreamInfo->NumberOfStreams;
+    index = start;
+    minLoad = pStreamInfo->StreamLoad[start];
+
+    for (i = 1; i < pStreamInfo->NumberOfStreams && minLoad > 0; i++) {
+
+        candidate = (start + i) % pStreamInfo->NumberOfStreams;
+        load = pStreamInfo->StreamLoad[candidate];
+
+        if (load < minLoad) {
+            minLoad = load;
+            index = candidate;
+        }
+    }
+
+    load = InterlockedIncrement(&pStreamInfo->StreamLoad[index]);
+
+    rwContext->StreamId = pStreamInfo->StreamList[index].StreamID;
+
+    UsbSamp_DbgPrint(3, ("Request scheduled on stream %d, %d in flight\n",
+                         rwContext->StreamId, load));
 
     streamPipeHandle = pStreamInfo->StreamList[index].PipeHandle;
 
@@ -363,13 +429,60 @@ Return Value:
     // its associated stream's PipeHandle .
     //
     urb = irpSp->Parameters.Others.Argument1;
-    urb->UrbBulkOrInterruptTransfer.PipeHandle = GetStreamPipeHandleFromBulkPipe(Pipe);
+    urb->UrbBulkOrInterruptTransfer.PipeHandle = AcquireStreamForRequest(Request, Pipe);
 
 }
 
 
 #endif
 
+VOID
+ReleaseStreamForRequest(
+    _In_ WDFREQUEST       Request
+    )
+/*++
+
+Routine Description:
+
+    This routine is called before a read or write request is completed.
+    If the request was scheduled on a stream, it's no longer in flight on
+    that stream.
+
+Arguments:
+
+    Request - Read/Write Request.
+
+Return Value:
+
+    NULL
+
+--*/
+{
+#if (NTDDI_VERSION >= NTDDI_WIN8)
+    PREQUEST_CONTEXT            rwContext;
+    PPIPE_CONTEXT               pipeContext;
+    PUSBSAMP_STREAM_INFO        pStreamInfo;
+
+    rwContext = GetRequestContext(Request);
+
+    if (rwContext->StreamId == 0) {
+        return;
+    }
+
+    pipeContext = GetPipeContext(GetFileContext(WdfRequestGetFileObject(Request))->Pipe);
+    pStreamInfo = &pipeContext->StreamInfo;
+
+    if (pStreamInfo->StreamLoad != NULL &&
+        rwContext->StreamId <= pStreamInfo->NumberOfStreams) {
+        InterlockedDecrement(&pStreamInfo->StreamLoad[rwContext->StreamId - 1]);
+    }
+
+    rwContext->StreamId = 0;
+#else
+    UNREFERENCED_PARAMETER(Request);
+#endif
+}
+
 ULONG
 GetMaxTransferSize(
     _In_ WDFUSBPIPE         Pipe,
@@ -53,6 +53,10 @@ LIST_ENTRY AllocListHead =
     &AllocListHead
 };
 
+// The hub ports are enumerated on thread pool threads, which allocate too.
+//
+SRWLOCK AllocListLock = SRWLOCK_INIT;
+
 
 /*****************************************************************************
 
@@ -84,7 +88,9 @@ MyAlloc (
 
         if (header != NULL)
         {
+            AcquireSRWLockExclusive(&AllocListLock);
             InsertTailList(&AllocListHead, &header->ListEntry);
+            ReleaseSRWLockExclusive(&AllocListLock);
 
             header->File = File;
             header->Line = Line;
@@ -122,7 +128,9 @@ MyReAlloc (
 
     // Remove the old address from the allocation list
     //
+    AcquireSRWLockExclusive(&AllocListLock);
     RemoveEntryList(&header->ListEntry);
+    ReleaseSRWLockExclusive(&AllocListLock);
 
     if (dwBytes < (dwBytes + (DWORD) sizeof(ALLOCHEADER)))
         {
@@ -135,13 +143,17 @@ MyReAlloc (
             // and the original handle and pointer are still valid.
             // Add the old address back to the allocation list.
             //
+            AcquireSRWLockExclusive(&AllocListLock);
             InsertTailList(&AllocListHead, &header->ListEntry);
+            ReleaseSRWLockExclusive(&AllocListLock);
         }
         else
         {
             // Add the new address to the allocation list
             //
+            AcquireSRWLockExclusive(&AllocListLock);
             InsertTailList(&AllocListHead, &headerNew->ListEntry);
+            ReleaseSRWLockExclusive(&AllocListLock);
 
             return (HGLOBAL)(headerNew + 1);
         }
@@ -169,7 +181,9 @@ MyFree (
 
         header--;
 
+        AcquireSRWLockExclusive(&AllocListLock);
         RemoveEntryList(&header->ListEntry);
+        ReleaseSRWLockExclusive(&AllocListLock);
 
         return GlobalFree((HGLOBAL)header);
     }
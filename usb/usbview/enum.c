@@ -43,12 +43,24 @@ Abstract:
     to get the symbolic link name of the hub attached to the downstream
     port.  If there is a hub attached to the downstream port, recurse to
     step (2).  
+
+    QueryHubPort()
+    The requests for the ports of a hub are sent on the thread pool, all
+    ports at the same time.  The ports are then added to the TreeView in
+    order, on the thread that enumerates the hub.
     
     GetAllStringDescriptors()
     GetConfigDescriptor()
     Create a node in the TreeView to represent each hub port
     and attached device.
 
+    LookupCachedDescriptors()
+    CacheDescriptors()
+    The descriptors of each device are kept across enumerations.  A device
+    that still has the same driver key name, address and device descriptor
+    is not asked for them again, so a refresh after a device change only
+    sends descriptor requests to the devices that changed.
+
 
 Environment:
 
@@ -72,6 +84,50 @@ Revision History:
 
 #define NUM_STRING_DESC_TO_GET 32
 
+//*****************************************************************************
+// T Y P E D E F S
+//*****************************************************************************
+
+// What QueryHubPort() found out about one downstream port of a hub.
+//
+typedef struct _PORT_QUERY
+{
+    HANDLE                                  hHubDevice;
+    ULONG                                   ConnectionIndex;
+    PUSB_NODE_CONNECTION_INFORMATION_EX     ConnectionInfoEx;
+    PUSB_NODE_CONNECTION_INFORMATION_EX_V2  ConnectionInfoExV2;
+    PUSB_PORT_CONNECTOR_PROPERTIES          PortConnectorProps;
+    PCHAR                                   DriverKeyName;
+    PUSB_DESCRIPTOR_REQUEST                 ConfigDesc;
+    PUSB_DESCRIPTOR_REQUEST                 BosDesc;
+    PSTRING_DESCRIPTOR_NODE                 StringDescs;
+    PCHAR                                   ExtHubName;
+} PORT_QUERY, *PPORT_QUERY;
+
+// The ports of a hub being queried on the thread pool.
+//
+typedef struct _HUB_PORTS_QUERY
+{
+    ULONG           NumPorts;
+    LONG volatile   NextPort;
+    PPORT_QUERY     Ports;
+} HUB_PORTS_QUERY, *PHUB_PORTS_QUERY;
+
+// Descriptors read from a device instance by a previous enumeration.
+//
+typedef struct _DESCRIPTOR_CACHE_ENTRY
+{
+    LIST_ENTRY              ListEntry;
+    PCHAR                   DriverKeyName;
+    USHORT                  DeviceAddress;
+    UCHAR                   CurrentConfigurationValue;
+    USB_DEVICE_DESCRIPTOR   DeviceDescriptor;
+    PUSB_DESCRIPTOR_REQUEST ConfigDesc;
+    PUSB_DESCRIPTOR_REQUEST BosDesc;
+    PSTRING_DESCRIPTOR_NODE StringDescs;
+    BOOL                    Used;
+} DESCRIPTOR_CACHE_ENTRY, *PDESCRIPTOR_CACHE_ENTRY;
+
 //*****************************************************************************
 // L O C A L    F U N C T I O N    P R O T O T Y P E S
 //*****************************************************************************
@@ -112,6 +168,65 @@ EnumerateHubPorts (
     ULONG       NumPorts
 );
 
+VOID
+QueryHubPort (
+    _Inout_ PPORT_QUERY Query
+);
+
+VOID
+CALLBACK
+QueryHubPortsCallback (
+    _Inout_     PTP_CALLBACK_INSTANCE Instance,
+    _Inout_opt_ PVOID                 Context,
+    _Inout_     PTP_WORK              Work
+);
+
+VOID
+AddHubPort (
+    HTREEITEM   hTreeParent,
+    PPORT_QUERY Query
+);
+
+PUSB_DESCRIPTOR_REQUEST
+CopyDescriptorRequest (
+    _In_ PUSB_DESCRIPTOR_REQUEST DescReq
+);
+
+PSTRING_DESCRIPTOR_NODE
+CopyStringDescriptors (
+    _In_ PSTRING_DESCRIPTOR_NODE StringDescs
+);
+
+VOID
+FreeStringDescriptors (
+    _In_opt_ PSTRING_DESCRIPTOR_NODE StringDescs
+);
+
+VOID
+FreeCacheEntry (
+    _In_ PDESCRIPTOR_CACHE_ENTRY Entry
+);
+
+PDESCRIPTOR_CACHE_ENTRY
+FindCacheEntry (
+    _In_ PCHAR DriverKeyName
+);
+
+BOOL
+LookupCachedDescriptors (
+    _Inout_ PPORT_QUERY Query
+);
+
+VOID
+CacheDescriptors (
+    _In_ PPORT_QUERY Query
+);
+
+VOID
+PruneDescriptorCache (
+    VOID
+);
+
 PCHAR GetRootHubName (
     HANDLE HostController
 );
@@ -249,6 +364,18 @@ PCHAR ConnectionStatuses[] =
 
 ULONG TotalDevicesConnected;
 
+// Descriptors kept across enumerations, see LookupCachedDescriptors().
+// DescriptorCacheLock protects the list, since the ports are queried on
+// thread pool threads.
+//
+LIST_ENTRY DescriptorCacheListHead =
+{
+    &DescriptorCacheListHead,
+    &DescriptorCacheListHead
+};
+
+SRWLOCK DescriptorCacheLock = SRWLOCK_INIT;
+
 
 //*****************************************************************************
 //
@@ -371,6 +498,10 @@ EnumerateHostControllers (
 
     SetupDiDestroyDeviceInfoList(deviceInfo);
 
+    // Forget the descriptors of the devices that are gone
+    //
+    PruneDescriptorCache();
+
     *DevicesConnected = TotalDevicesConnected;
 
     return;
@@ -980,219 +1111,176 @@ EnumerateHubError:
 
 //*****************************************************************************
 //
-// EnumerateHubPorts()
-//
-// hTreeParent - Handle of the TreeView item under which the hub port should
-// be added.
+// QueryHubPort()
 //
-// hHubDevice - Handle of the hub device to enumerate.
+// Sends the hub the requests for one downstream port and reads the
+// descriptors of the device attached to it, if any.  It only fills Query
+// and does not touch the TreeView or the globals, so it can run on a thread
+// pool thread while the other ports of the hub are queried.
 //
-// NumPorts - Number of ports on the hub.
+// Query->ConnectionInfoEx is left NULL if the port could not be queried.
 //
 //*****************************************************************************
 
 VOID
-EnumerateHubPorts (
-    HTREEITEM   hTreeParent,
-    HANDLE      hHubDevice,
-    ULONG       NumPorts
+QueryHubPort (
+    _Inout_ PPORT_QUERY Query
 )
 {
-    ULONG       index = 0;
+    HANDLE      hHubDevice = Query->hHubDevice;
+    ULONG       index = Query->ConnectionIndex;
     BOOL        success = 0;
-    HRESULT     hr = S_OK;
-    PCHAR       driverKeyName = NULL;
-    PUSB_DEVICE_PNP_STRINGS DevProps;
-    DWORD       dwSizeOfLeafName = 0;
-    CHAR        leafName[512];
-    int         icon = 0;
+    ULONG       nBytesEx = 0;
+    ULONG       nBytes = 0;
 
-    PUSB_NODE_CONNECTION_INFORMATION_EX    connectionInfoEx;
-    PUSB_PORT_CONNECTOR_PROPERTIES         pPortConnectorProps;
+    PUSB_NODE_CONNECTION_INFORMATION_EX    connectionInfoEx = NULL;
+    PUSB_PORT_CONNECTOR_PROPERTIES         pPortConnectorProps = NULL;
     USB_PORT_CONNECTOR_PROPERTIES          portConnectorProps;
-    PUSB_DESCRIPTOR_REQUEST                configDesc;
-    PUSB_DESCRIPTOR_REQUEST                bosDesc;
-    PSTRING_DESCRIPTOR_NODE                stringDescs;
-    PUSBDEVICEINFO                         info;
-    PUSB_NODE_CONNECTION_INFORMATION_EX_V2 connectionInfoExV2;
-    PDEVICE_INFO_NODE                      pNode;
+    PUSB_NODE_CONNECTION_INFORMATION_EX_V2 connectionInfoExV2 = NULL;
+
+    ZeroMemory(&portConnectorProps, sizeof(portConnectorProps));
 
-    // Loop over all ports of the hub.
     //
-    // Port indices are 1 based, not 0 based.
+    // Allocate space to hold the connection info for this port.
+    // For now, allocate it big enough to hold info for 30 pipes.
+    //
+    // Endpoint numbers are 0-15.  Endpoint number 0 is the standard
+    // control endpoint which is not explicitly listed in the Configuration
+    // Descriptor.  There can be an IN endpoint and an OUT endpoint at
+    // endpoint numbers 1-15 so there can be a maximum of 30 endpoints
+    // per device configuration.
+    //
+    // Should probably size this dynamically at some point.
     //
-    for (index = 1; index <= NumPorts; index++)
-    {
-        ULONG nBytesEx;
-        ULONG nBytes = 0;
-
-        connectionInfoEx = NULL;
-        pPortConnectorProps = NULL;
-        ZeroMemory(&portConnectorProps, sizeof(portConnectorProps));
-        configDesc = NULL;
-        bosDesc = NULL;
-        stringDescs = NULL;
-        info = NULL;
-        connectionInfoExV2 = NULL;
-        pNode = NULL;
-        DevProps = NULL;
-        ZeroMemory(leafName, sizeof(leafName));
 
-        //
-        // Allocate space to hold the connection info for this port.
-        // For now, allocate it big enough to hold info for 30 pipes.
-        //
-        // Endpoint numbers are 0-15.  Endpoint number 0 is the standard
-        // control endpoint which is not explicitly listed in the Configuration
-        // Descriptor.  There can be an IN endpoint and an OUT endpoint at
-        // endpoint numbers 1-15 so there can be a maximum of 30 endpoints
-        // per device configuration.
-        //
-        // Should probably size this dynamically at some point.
-        //
+    nBytesEx = sizeof(USB_NODE_CONNECTION_INFORMATION_EX) +
+             (sizeof(USB_PIPE_INFO) * 30);
 
-        nBytesEx = sizeof(USB_NODE_CONNECTION_INFORMATION_EX) +
-                 (sizeof(USB_PIPE_INFO) * 30);
+    connectionInfoEx = (PUSB_NODE_CONNECTION_INFORMATION_EX)ALLOC(nBytesEx);
 
-        connectionInfoEx = (PUSB_NODE_CONNECTION_INFORMATION_EX)ALLOC(nBytesEx);
+    if (connectionInfoEx == NULL)
+    {
+        OOPS();
+        return;
+    }
 
-        if (connectionInfoEx == NULL)
-        {
-            OOPS();
-            break;
-        }
+    connectionInfoExV2 = (PUSB_NODE_CONNECTION_INFORMATION_EX_V2) 
+                                ALLOC(sizeof(USB_NODE_CONNECTION_INFORMATION_EX_V2));
 
-        connectionInfoExV2 = (PUSB_NODE_CONNECTION_INFORMATION_EX_V2) 
-                                    ALLOC(sizeof(USB_NODE_CONNECTION_INFORMATION_EX_V2));
+    if (connectionInfoExV2 == NULL)
+    {
+        OOPS();
+        FREE(connectionInfoEx);
+        return;
+    }
+    
+    //
+    // Now query USBHUB for the structures
+    // for this port.  This will tell us if a device is attached to this
+    // port, among other things.
+    // The fault tolerate code is executed first.
+    //
 
-        if (connectionInfoExV2 == NULL)
-        {
-            OOPS();
-            FREE(connectionInfoEx);
-            break;
-        }
-        
-        //
-        // Now query USBHUB for the structures
-        // for this port.  This will tell us if a device is attached to this
-        // port, among other things.
-        // The fault tolerate code is executed first.
-        //
+    portConnectorProps.ConnectionIndex = index;
 
-        portConnectorProps.ConnectionIndex = index;
+    success = DeviceIoControl(hHubDevice,
+                              IOCTL_USB_GET_PORT_CONNECTOR_PROPERTIES,
+                              &portConnectorProps,
+                              sizeof(USB_PORT_CONNECTOR_PROPERTIES),
+                              &portConnectorProps,
+                              sizeof(USB_PORT_CONNECTOR_PROPERTIES),
+                              &nBytes,
+                              NULL);
 
-        success = DeviceIoControl(hHubDevice,
-                                  IOCTL_USB_GET_PORT_CONNECTOR_PROPERTIES,
-                                  &portConnectorProps,
-                                  sizeof(USB_PORT_CONNECTOR_PROPERTIES),
-                                  &portConnectorProps,
-                                  sizeof(USB_PORT_CONNECTOR_PROPERTIES),
-                                  &nBytes,
-                                  NULL);
+    if (success && nBytes == sizeof(USB_PORT_CONNECTOR_PROPERTIES)) 
+    {
+        pPortConnectorProps = (PUSB_PORT_CONNECTOR_PROPERTIES)
+                                    ALLOC(portConnectorProps.ActualLength);
 
-        if (success && nBytes == sizeof(USB_PORT_CONNECTOR_PROPERTIES)) 
+        if (pPortConnectorProps != NULL)
         {
-            pPortConnectorProps = (PUSB_PORT_CONNECTOR_PROPERTIES)
-                                        ALLOC(portConnectorProps.ActualLength);
+            pPortConnectorProps->ConnectionIndex = index;
+            
+            success = DeviceIoControl(hHubDevice,
+                                      IOCTL_USB_GET_PORT_CONNECTOR_PROPERTIES,
+                                      pPortConnectorProps,
+                                      portConnectorProps.ActualLength,
+                                      pPortConnectorProps,
+                                      portConnectorProps.ActualLength,
+                                      &nBytes,
+                                      NULL);
 
-            if (pPortConnectorProps != NULL)
+            if (!success || nBytes < portConnectorProps.ActualLength)
             {
-                pPortConnectorProps->ConnectionIndex = index;
-                
-                success = DeviceIoControl(hHubDevice,
-                                          IOCTL_USB_GET_PORT_CONNECTOR_PROPERTIES,
-                                          pPortConnectorProps,
-                                          portConnectorProps.ActualLength,
-                                          pPortConnectorProps,
-                                          portConnectorProps.ActualLength,
-                                          &nBytes,
-                                          NULL);
-
-                if (!success || nBytes < portConnectorProps.ActualLength)
-                {
-                    FREE(pPortConnectorProps);
-                    pPortConnectorProps = NULL;
-                }
+                FREE(pPortConnectorProps);
+                pPortConnectorProps = NULL;
             }
         }
-        
-        connectionInfoExV2->ConnectionIndex = index;
-        connectionInfoExV2->Length = sizeof(USB_NODE_CONNECTION_INFORMATION_EX_V2);
-        connectionInfoExV2->SupportedUsbProtocols.Usb300 = 1;
-
-        success = DeviceIoControl(hHubDevice,
-                                  IOCTL_USB_GET_NODE_CONNECTION_INFORMATION_EX_V2,
-                                  connectionInfoExV2,
-                                  sizeof(USB_NODE_CONNECTION_INFORMATION_EX_V2),
-                                  connectionInfoExV2,
-                                  sizeof(USB_NODE_CONNECTION_INFORMATION_EX_V2),
-                                  &nBytes,
-                                  NULL);
-
-        if (!success || nBytes < sizeof(USB_NODE_CONNECTION_INFORMATION_EX_V2)) 
-        {
-            FREE(connectionInfoExV2);
-            connectionInfoExV2 = NULL;
-        }
+    }
+    
+    connectionInfoExV2->ConnectionIndex = index;
+    connectionInfoExV2->Length = sizeof(USB_NODE_CONNECTION_INFORMATION_EX_V2);
+    connectionInfoExV2->SupportedUsbProtocols.Usb300 = 1;
 
-        connectionInfoEx->ConnectionIndex = index;
+    success = DeviceIoControl(hHubDevice,
+                              IOCTL_USB_GET_NODE_CONNECTION_INFORMATION_EX_V2,
+                              connectionInfoExV2,
+                              sizeof(USB_NODE_CONNECTION_INFORMATION_EX_V2),
+                              connectionInfoExV2,
+                              sizeof(USB_NODE_CONNECTION_INFORMATION_EX_V2),
+                              &nBytes,
+                              NULL);
 
-        success = DeviceIoControl(hHubDevice,
-                                  IOCTL_USB_GET_NODE_CONNECTION_INFORMATION_EX,
-                                  connectionInfoEx,
-                                  nBytesEx,
-                                  connectionInfoEx,
-                                  nBytesEx,
-                                  &nBytesEx,
-                                  NULL);
+    if (!success || nBytes < sizeof(USB_NODE_CONNECTION_INFORMATION_EX_V2)) 
+    {
+        FREE(connectionInfoExV2);
+        connectionInfoExV2 = NULL;
+    }
 
-        if (success)
-        {
-            //
-            // Since the USB_NODE_CONNECTION_INFORMATION_EX is used to display
-            // the device speed, but the hub driver doesn't support indication
-            // of superspeed, we overwrite the value if the super speed
-            // data structures are available and indicate the device is operating
-            // at SuperSpeed.
-            // 
-            
-            if (connectionInfoEx->Speed == UsbHighSpeed 
-                && connectionInfoExV2 != NULL 
-                && (connectionInfoExV2->Flags.DeviceIsOperatingAtSuperSpeedOrHigher ||
-                    connectionInfoExV2->Flags.DeviceIsOperatingAtSuperSpeedPlusOrHigher))
-            {
-                connectionInfoEx->Speed = UsbSuperSpeed;
-            }
-        } 
-        else 
-        {
-            PUSB_NODE_CONNECTION_INFORMATION    connectionInfo = NULL;
+    connectionInfoEx->ConnectionIndex = index;
 
-            // Try using IOCTL_USB_GET_NODE_CONNECTION_INFORMATION
-            // instead of IOCTL_USB_GET_NODE_CONNECTION_INFORMATION_EX
-            //
+    success = DeviceIoControl(hHubDevice,
+                              IOCTL_USB_GET_NODE_CONNECTION_INFORMATION_EX,
+                              connectionInfoEx,
+                              nBytesEx,
+                              connectionInfoEx,
+                              nBytesEx,
+                              &nBytesEx,
+                              NULL);
 
-            nBytes = sizeof(USB_NODE_CONNECTION_INFORMATION) +
-                     sizeof(USB_PIPE_INFO) * 30;
+    if (success)
+    {
+        //
+        // Since the USB_NODE_CONNECTION_INFORMATION_EX is used to display
+        // the device speed, but the hub driver doesn't support indication
+        // of superspeed, we overwrite the value if the super speed
+        // data structures are available and indicate the device is operating
+        // at SuperSpeed.
+        // 
+        
+        if (connectionInfoEx->Speed == UsbHighSpeed 
+            && connectionInfoExV2 != NULL 
+            && (connectionInfoExV2->Flags.DeviceIsOperatingAtSuperSpeedOrHigher ||
+                connectionInfoExV2->Flags.DeviceIsOperatingAtSuperSpeedPlusOrHigher))
+        {
+            connectionInfoEx->Speed = UsbSuperSpeed;
+        }
+    } 
+    else 
+    {
+        PUSB_NODE_CONNECTION_INFORMATION    connectionInfo = NULL;
 
-            connectionInfo = (PUSB_NODE_CONNECTION_INFORMATION)ALLOC(nBytes);
+        // Try using IOCTL_USB_GET_NODE_CONNECTION_INFORMATION
+        // instead of IOCTL_USB_GET_NODE_CONNECTION_INFORMATION_EX
+        //
 
-            if (connectionInfo == NULL) 
-            {
-                OOPS();
+        nBytes = sizeof(USB_NODE_CONNECTION_INFORMATION) +
+                 sizeof(USB_PIPE_INFO) * 30;
 
-                FREE(connectionInfoEx);
-                if (pPortConnectorProps != NULL)
-                {
-                    FREE(pPortConnectorProps);
-                }
-                if (connectionInfoExV2 != NULL)
-                {
-                    FREE(connectionInfoExV2);
-                }
-                continue;                
-            }
+        connectionInfo = (PUSB_NODE_CONNECTION_INFORMATION)ALLOC(nBytes);
 
+        if (connectionInfo != NULL) 
+        {
             connectionInfo->ConnectionIndex = index;
 
             success = DeviceIoControl(hHubDevice,
@@ -1203,247 +1291,806 @@ EnumerateHubPorts (
                                       nBytes,
                                       &nBytes,
                                       NULL);
+        }
 
-            if (!success)
-            {
-                OOPS();
+        if (connectionInfo == NULL || !success)
+        {
+            OOPS();
 
+            if (connectionInfo != NULL)
+            {
                 FREE(connectionInfo);
-                FREE(connectionInfoEx);
-                if (pPortConnectorProps != NULL)
-                {
-                    FREE(pPortConnectorProps);
-                }
-                if (connectionInfoExV2 != NULL)
-                {
-                    FREE(connectionInfoExV2);
-                }
-                continue;
             }
-
-            // Copy IOCTL_USB_GET_NODE_CONNECTION_INFORMATION into
-            // IOCTL_USB_GET_NODE_CONNECTION_INFORMATION_EX structure.
-            //
-            connectionInfoEx->ConnectionIndex = connectionInfo->ConnectionIndex;
-            connectionInfoEx->DeviceDescriptor = connectionInfo->DeviceDescriptor;
-            connectionInfoEx->CurrentConfigurationValue = connectionInfo->CurrentConfigurationValue;
-            connectionInfoEx->Speed = connectionInfo->LowSpeed ? UsbLowSpeed : UsbFullSpeed;
-            connectionInfoEx->DeviceIsHub = connectionInfo->DeviceIsHub;
-            connectionInfoEx->DeviceAddress = connectionInfo->DeviceAddress;
-            connectionInfoEx->NumberOfOpenPipes = connectionInfo->NumberOfOpenPipes;
-            connectionInfoEx->ConnectionStatus = connectionInfo->ConnectionStatus;
-
-            memcpy(&connectionInfoEx->PipeList[0],
-                   &connectionInfo->PipeList[0],
-                   sizeof(USB_PIPE_INFO) * 30);
-
-            FREE(connectionInfo);
+            FREE(connectionInfoEx);
+            if (pPortConnectorProps != NULL)
+            {
+                FREE(pPortConnectorProps);
+            }
+            if (connectionInfoExV2 != NULL)
+            {
+                FREE(connectionInfoExV2);
+            }
+            return;
         }
 
-        // Update the count of connected devices
+        // Copy IOCTL_USB_GET_NODE_CONNECTION_INFORMATION into
+        // IOCTL_USB_GET_NODE_CONNECTION_INFORMATION_EX structure.
         //
-        if (connectionInfoEx->ConnectionStatus == DeviceConnected)
-        {
-            TotalDevicesConnected++;
-        }
-
-        if (connectionInfoEx->DeviceIsHub)
-        {
-            TotalHubs++;
-        }
+        connectionInfoEx->ConnectionIndex = connectionInfo->ConnectionIndex;
+        connectionInfoEx->DeviceDescriptor = connectionInfo->DeviceDescriptor;
+        connectionInfoEx->CurrentConfigurationValue = connectionInfo->CurrentConfigurationValue;
+        connectionInfoEx->Speed = connectionInfo->LowSpeed ? UsbLowSpeed : UsbFullSpeed;
+        connectionInfoEx->DeviceIsHub = connectionInfo->DeviceIsHub;
+        connectionInfoEx->DeviceAddress = connectionInfo->DeviceAddress;
+        connectionInfoEx->NumberOfOpenPipes = connectionInfo->NumberOfOpenPipes;
+        connectionInfoEx->ConnectionStatus = connectionInfo->ConnectionStatus;
 
-        // If there is a device connected, get the Device Description
-        //
-        if (connectionInfoEx->ConnectionStatus != NoDeviceConnected)
-        {
-            driverKeyName = GetDriverKeyName(hHubDevice, index);
+        memcpy(&connectionInfoEx->PipeList[0],
+               &connectionInfo->PipeList[0],
+               sizeof(USB_PIPE_INFO) * 30);
 
-            if (driverKeyName)
-            {
-                size_t cbDriverName = 0;
+        FREE(connectionInfo);
+    }
 
-                hr = StringCbLength(driverKeyName, MAX_DRIVER_KEY_NAME, &cbDriverName);
-                if (SUCCEEDED(hr))
-                {
-                    DevProps = DriverNameToDeviceProperties(driverKeyName, cbDriverName);
-                    pNode = FindMatchingDeviceNodeForDriverName(driverKeyName, connectionInfoEx->DeviceIsHub);
-                }
-                FREE(driverKeyName);
-            }
+    Query->ConnectionInfoEx = connectionInfoEx;
+    Query->ConnectionInfoExV2 = connectionInfoExV2;
+    Query->PortConnectorProps = pPortConnectorProps;
 
-        }
+    // If there is a device connected, get its driver key name
+    //
+    if (connectionInfoEx->ConnectionStatus != NoDeviceConnected)
+    {
+        Query->DriverKeyName = GetDriverKeyName(hHubDevice, index);
+    }
 
-        // If there is a device connected to the port, try to retrieve the
-        // Configuration Descriptor from the device.
-        //
-        if (gDoConfigDesc &&
-            connectionInfoEx->ConnectionStatus == DeviceConnected)
-        {
-            configDesc = GetConfigDescriptor(hHubDevice,
-                                             index,
-                                             0);
-        }
-        else
-        {
-            configDesc = NULL;
-        }
+    // If there is a device connected to the port, try to retrieve the
+    // descriptors from the device, unless they are cached from the previous
+    // enumeration.
+    //
+    if (gDoConfigDesc &&
+        connectionInfoEx->ConnectionStatus == DeviceConnected &&
+        !LookupCachedDescriptors(Query))
+    {
+        Query->ConfigDesc = GetConfigDescriptor(hHubDevice,
+                                                index,
+                                                0);
 
-        if (configDesc != NULL &&
+        if (Query->ConfigDesc != NULL &&
             connectionInfoEx->DeviceDescriptor.bcdUSB >= 0x0210)
         {
-            bosDesc = GetBOSDescriptor(hHubDevice,
-                                       index);
-        }
-        else
-        {
-            bosDesc = NULL;
+            Query->BosDesc = GetBOSDescriptor(hHubDevice,
+                                              index);
         }
 
-        if (configDesc != NULL &&
+        if (Query->ConfigDesc != NULL &&
             AreThereStringDescriptors(&connectionInfoEx->DeviceDescriptor,
-                                      (PUSB_CONFIGURATION_DESCRIPTOR)(configDesc+1)))
-        {
-            stringDescs = GetAllStringDescriptors (
-                              hHubDevice,
-                              index,
-                              &connectionInfoEx->DeviceDescriptor,
-                              (PUSB_CONFIGURATION_DESCRIPTOR)(configDesc+1));
-        }
-        else
+                                      (PUSB_CONFIGURATION_DESCRIPTOR)(Query->ConfigDesc+1)))
         {
-            stringDescs = NULL;
+            Query->StringDescs = GetAllStringDescriptors (
+                                     hHubDevice,
+                                     index,
+                                     &connectionInfoEx->DeviceDescriptor,
+                                     (PUSB_CONFIGURATION_DESCRIPTOR)(Query->ConfigDesc+1));
         }
 
-        // If the device connected to the port is an external hub, get the
-        // name of the external hub and recursively enumerate it.
-        //
-        if (connectionInfoEx->DeviceIsHub)
+        if (Query->ConfigDesc != NULL)
         {
-            PCHAR extHubName;
-            size_t cbHubName = 0;
-
-            extHubName = GetExternalHubName(hHubDevice, index);
-            if (extHubName != NULL)
-            {
-                hr = StringCbLength(extHubName, MAX_DRIVER_KEY_NAME, &cbHubName);
-                if (SUCCEEDED(hr))
-                {
-                    EnumerateHub(hTreeParent, //hPortItem,
-                            extHubName,
-                            cbHubName,
-                            connectionInfoEx,
-                            connectionInfoExV2,
-                            pPortConnectorProps,
-                            configDesc,
-                            bosDesc,
-                            stringDescs,
-                            DevProps);
-                }
-            }
+            CacheDescriptors(Query);
         }
-        else
-        {
-            // Allocate some space for a USBDEVICEINFO structure to hold the
-            // hub info, hub name, and connection info pointers.  GPTR zero
-            // initializes the structure for us.
-            //
-            info = (PUSBDEVICEINFO) ALLOC(sizeof(USBDEVICEINFO));
+    }
 
-            if (info == NULL)
-            {
-                OOPS();
-                if (configDesc != NULL)
-                {
-                    FREE(configDesc);
-                }
-                if (bosDesc != NULL)
-                {
-                    FREE(bosDesc);
-                }
-                FREE(connectionInfoEx);
-                
-                if (pPortConnectorProps != NULL)
-                {
-                    FREE(pPortConnectorProps);
-                }
-                if (connectionInfoExV2 != NULL)
-                {
-                    FREE(connectionInfoExV2);
-                }
-                break;
-            }
+    // If the device connected to the port is an external hub, get the
+    // name of the external hub.
+    //
+    if (connectionInfoEx->DeviceIsHub)
+    {
+        Query->ExtHubName = GetExternalHubName(hHubDevice, index);
+    }
+}
 
-            info->DeviceInfoType = DeviceInfo;
-            info->ConnectionInfo = connectionInfoEx;
-            info->PortConnectorProps = pPortConnectorProps;
-            info->ConfigDesc = configDesc;
-            info->StringDescs = stringDescs;
-            info->BosDesc = bosDesc;
-            info->ConnectionInfoV2 = connectionInfoExV2;
-            info->UsbDeviceProperties = DevProps;
-            info->DeviceInfoNode = pNode;
+//*****************************************************************************
+//
+// QueryHubPortsCallback()
+//
+// Thread pool work callback of EnumerateHubPorts().  Each submission of the
+// work queries the next port that nobody has taken yet.
+//
+//*****************************************************************************
 
-            StringCchPrintf(leafName, sizeof(leafName), "[Port%d] ", index);
+VOID
+CALLBACK
+QueryHubPortsCallback (
+    _Inout_     PTP_CALLBACK_INSTANCE Instance,
+    _Inout_opt_ PVOID                 Context,
+    _Inout_     PTP_WORK              Work
+)
+{
+    PHUB_PORTS_QUERY hubQuery = (PHUB_PORTS_QUERY)Context;
+    LONG             port = 0;
 
-            // Add error description if ConnectionStatus is other than NoDeviceConnected / DeviceConnected
-            StringCchCat(leafName, 
-                sizeof(leafName), 
-                ConnectionStatuses[connectionInfoEx->ConnectionStatus]);
+    UNREFERENCED_PARAMETER(Instance);
+    UNREFERENCED_PARAMETER(Work);
 
-            if (DevProps)
-            {
-                size_t cchDeviceDesc = 0;
+    if (hubQuery == NULL)
+    {
+        return;
+    }
 
-                hr = StringCbLength(DevProps->DeviceDesc, MAX_DEVICE_PROP, &cchDeviceDesc);
-                if (FAILED(hr))
-                {
-                    OOPS();
-                }
-                dwSizeOfLeafName = sizeof(leafName);
-                StringCchCatN(leafName, 
-                    dwSizeOfLeafName - 1, 
-                    " :  ",
-                    sizeof(" :  "));
-                StringCchCatN(leafName, 
-                    dwSizeOfLeafName - 1, 
-                    DevProps->DeviceDesc,
-                    cchDeviceDesc );
-            }
+    port = InterlockedIncrement(&hubQuery->NextPort) - 1;
 
-            if (connectionInfoEx->ConnectionStatus == NoDeviceConnected)
-            {
-                if (connectionInfoExV2 != NULL &&
-                    connectionInfoExV2->SupportedUsbProtocols.Usb300 == 1)
-                {
-                    icon = NoSsDeviceIcon;
-                }
-                else
-                {
-                    icon = NoDeviceIcon;
-                }
-            }
-            else if (connectionInfoEx->CurrentConfigurationValue)
+    if (port < (LONG)hubQuery->NumPorts)
+    {
+        QueryHubPort(&hubQuery->Ports[port]);
+    }
+}
+
+//*****************************************************************************
+//
+// AddHubPort()
+//
+// hTreeParent - Handle of the TreeView item under which the hub port should
+// be added.
+//
+// Query - The port, as queried by QueryHubPort().  The tree takes over the
+// allocations it holds.
+//
+//*****************************************************************************
+
+VOID
+AddHubPort (
+    HTREEITEM   hTreeParent,
+    PPORT_QUERY Query
+)
+{
+    ULONG       index = Query->ConnectionIndex;
+    HRESULT     hr = S_OK;
+    PUSB_DEVICE_PNP_STRINGS DevProps = NULL;
+    DWORD       dwSizeOfLeafName = 0;
+    CHAR        leafName[512];
+    int         icon = 0;
+
+    PUSB_NODE_CONNECTION_INFORMATION_EX    connectionInfoEx = Query->ConnectionInfoEx;
+    PUSB_NODE_CONNECTION_INFORMATION_EX_V2 connectionInfoExV2 = Query->ConnectionInfoExV2;
+    PUSBDEVICEINFO                         info = NULL;
+    PDEVICE_INFO_NODE                      pNode = NULL;
+
+    ZeroMemory(leafName, sizeof(leafName));
+
+    // Update the count of connected devices
+    //
+    if (connectionInfoEx->ConnectionStatus == DeviceConnected)
+    {
+        TotalDevicesConnected++;
+    }
+
+    if (connectionInfoEx->DeviceIsHub)
+    {
+        TotalHubs++;
+    }
+
+    // If there is a device connected, get the Device Description
+    //
+    if (Query->DriverKeyName)
+    {
+        size_t cbDriverName = 0;
+
+        hr = StringCbLength(Query->DriverKeyName, MAX_DRIVER_KEY_NAME, &cbDriverName);
+        if (SUCCEEDED(hr))
+        {
+            DevProps = DriverNameToDeviceProperties(Query->DriverKeyName, cbDriverName);
+            pNode = FindMatchingDeviceNodeForDriverName(Query->DriverKeyName, connectionInfoEx->DeviceIsHub);
+        }
+        FREE(Query->DriverKeyName);
+        Query->DriverKeyName = NULL;
+    }
+
+    // If the device connected to the port is an external hub, recursively
+    // enumerate it.
+    //
+    if (connectionInfoEx->DeviceIsHub)
+    {
+        size_t cbHubName = 0;
+
+        if (Query->ExtHubName != NULL)
+        {
+            hr = StringCbLength(Query->ExtHubName, MAX_DRIVER_KEY_NAME, &cbHubName);
+            if (SUCCEEDED(hr))
             {
-                if (connectionInfoEx->Speed == UsbSuperSpeed)
-                {
-                    icon = GoodSsDeviceIcon;
-                }
-                else
-                {
-                    icon = GoodDeviceIcon;
-                }
+                EnumerateHub(hTreeParent, //hPortItem,
+                        Query->ExtHubName,
+                        cbHubName,
+                        connectionInfoEx,
+                        connectionInfoExV2,
+                        Query->PortConnectorProps,
+                        Query->ConfigDesc,
+                        Query->BosDesc,
+                        Query->StringDescs,
+                        DevProps);
+            }
+        }
+    }
+    else
+    {
+        // Allocate some space for a USBDEVICEINFO structure to hold the
+        // hub info, hub name, and connection info pointers.  GPTR zero
+        // initializes the structure for us.
+        //
+        info = (PUSBDEVICEINFO) ALLOC(sizeof(USBDEVICEINFO));
+
+        if (info == NULL)
+        {
+            OOPS();
+            if (Query->ConfigDesc != NULL)
+            {
+                FREE(Query->ConfigDesc);
+            }
+            if (Query->BosDesc != NULL)
+            {
+                FREE(Query->BosDesc);
+            }
+            FREE(connectionInfoEx);
+            
+            if (Query->PortConnectorProps != NULL)
+            {
+                FREE(Query->PortConnectorProps);
+            }
+            if (connectionInfoExV2 != NULL)
+            {
+                FREE(connectionInfoExV2);
+            }
+            return;
+        }
+
+        info->DeviceInfoType = DeviceInfo;
+        info->ConnectionInfo = connectionInfoEx;
+        info->PortConnectorProps = Query->PortConnectorProps;
+        info->ConfigDesc = Query->ConfigDesc;
+        info->StringDescs = Query->StringDescs;
+        info->BosDesc = Query->BosDesc;
+        info->ConnectionInfoV2 = connectionInfoExV2;
+        info->UsbDeviceProperties = DevProps;
+        info->DeviceInfoNode = pNode;
+
+        StringCchPrintf(leafName, sizeof(leafName), "[Port%d] ", index);
+
+        // Add error description if ConnectionStatus is other than NoDeviceConnected / DeviceConnected
+        StringCchCat(leafName, 
+            sizeof(leafName), 
+            ConnectionStatuses[connectionInfoEx->ConnectionStatus]);
+
+        if (DevProps)
+        {
+            size_t cchDeviceDesc = 0;
+
+            hr = StringCbLength(DevProps->DeviceDesc, MAX_DEVICE_PROP, &cchDeviceDesc);
+            if (FAILED(hr))
+            {
+                OOPS();
+            }
+            dwSizeOfLeafName = sizeof(leafName);
+            StringCchCatN(leafName, 
+                dwSizeOfLeafName - 1, 
+                " :  ",
+                sizeof(" :  "));
+            StringCchCatN(leafName, 
+                dwSizeOfLeafName - 1, 
+                DevProps->DeviceDesc,
+                cchDeviceDesc );
+        }
+
+        if (connectionInfoEx->ConnectionStatus == NoDeviceConnected)
+        {
+            if (connectionInfoExV2 != NULL &&
+                connectionInfoExV2->SupportedUsbProtocols.Usb300 == 1)
+            {
+                icon = NoSsDeviceIcon;
             }
             else
             {
-                icon = BadDeviceIcon;
+                icon = NoDeviceIcon;
             }
+        }
+        else if (connectionInfoEx->CurrentConfigurationValue)
+        {
+            if (connectionInfoEx->Speed == UsbSuperSpeed)
+            {
+                icon = GoodSsDeviceIcon;
+            }
+            else
+            {
+                icon = GoodDeviceIcon;
+            }
+        }
+        else
+        {
+            icon = BadDeviceIcon;
+        }
+
+        AddLeaf(hTreeParent, //hPortItem,
+                        (LPARAM)info,
+                        leafName,
+                        icon);
+    }
+}
+
+//*****************************************************************************
+//
+// EnumerateHubPorts()
+//
+// hTreeParent - Handle of the TreeView item under which the hub port should
+// be added.
+//
+// hHubDevice - Handle of the hub device to enumerate.
+//
+// NumPorts - Number of ports on the hub.
+//
+// The ports are queried at the same time on the default thread pool, since
+// most of the time goes to descriptor requests that are sent to the devices.
+// They are then added to the TreeView in port order on this thread, which
+// recurses into the external hubs.
+//
+//*****************************************************************************
+
+VOID
+EnumerateHubPorts (
+    HTREEITEM   hTreeParent,
+    HANDLE      hHubDevice,
+    ULONG       NumPorts
+)
+{
+    ULONG            index = 0;
+    HUB_PORTS_QUERY  hubQuery;
+    PTP_WORK         work = NULL;
+
+    if (NumPorts == 0)
+    {
+        return;
+    }
+
+    ZeroMemory(&hubQuery, sizeof(hubQuery));
+
+    hubQuery.NumPorts = NumPorts;
+    hubQuery.Ports = (PPORT_QUERY)ALLOC(sizeof(PORT_QUERY) * NumPorts);
+
+    if (hubQuery.Ports == NULL)
+    {
+        OOPS();
+        return;
+    }
+
+    // Port indices are 1 based, not 0 based.
+    //
+    for (index = 0; index < NumPorts; index++)
+    {
+        hubQuery.Ports[index].hHubDevice = hHubDevice;
+        hubQuery.Ports[index].ConnectionIndex = index + 1;
+    }
+
+    work = CreateThreadpoolWork(QueryHubPortsCallback, &hubQuery, NULL);
+
+    if (work != NULL)
+    {
+        for (index = 0; index < NumPorts; index++)
+        {
+            SubmitThreadpoolWork(work);
+        }
+
+        WaitForThreadpoolWorkCallbacks(work, FALSE);
+        CloseThreadpoolWork(work);
+    }
+    else
+    {
+        // Query the ports one after another
+        //
+        OOPS();
+
+        for (index = 0; index < NumPorts; index++)
+        {
+            QueryHubPort(&hubQuery.Ports[index]);
+        }
+    }
+
+    // Loop over all ports of the hub.
+    //
+    for (index = 0; index < NumPorts; index++)
+    {
+        if (hubQuery.Ports[index].ConnectionInfoEx != NULL)
+        {
+            AddHubPort(hTreeParent, &hubQuery.Ports[index]);
+        }
+    }
+
+    FREE(hubQuery.Ports);
+
+    // Show the ports of this hub while the rest of the tree is enumerated
+    //
+    TreeView_Expand(ghTreeWnd, hTreeParent, TVE_EXPAND);
+    UpdateWindow(ghTreeWnd);
+}
+
+
+//*****************************************************************************
+//
+// CopyDescriptorRequest()
+//
+// Returns a copy of a descriptor request returned by GetConfigDescriptor()
+// or GetBOSDescriptor().  The config and BOS descriptors both keep their
+// total length at the same offset.
+//
+//*****************************************************************************
+
+PUSB_DESCRIPTOR_REQUEST
+CopyDescriptorRequest (
+    _In_ PUSB_DESCRIPTOR_REQUEST DescReq
+)
+{
+    PUSB_DESCRIPTOR_REQUEST copy = NULL;
+    ULONG                   nBytes = 0;
+
+    nBytes = sizeof(USB_DESCRIPTOR_REQUEST) +
+             ((PUSB_CONFIGURATION_DESCRIPTOR)(DescReq+1))->wTotalLength;
+
+    copy = (PUSB_DESCRIPTOR_REQUEST)ALLOC(nBytes);
+
+    if (copy != NULL)
+    {
+        memcpy(copy, DescReq, nBytes);
+    }
+
+    return copy;
+}
+
+//*****************************************************************************
+//
+// CopyStringDescriptors()
+//
+// Returns a copy of a list of string descriptor nodes, or NULL if the list
+// could not be copied.
+//
+//*****************************************************************************
 
-            AddLeaf(hTreeParent, //hPortItem,
-                            (LPARAM)info,
-                            leafName,
-                            icon);
+PSTRING_DESCRIPTOR_NODE
+CopyStringDescriptors (
+    _In_ PSTRING_DESCRIPTOR_NODE StringDescs
+)
+{
+    PSTRING_DESCRIPTOR_NODE  head = NULL;
+    PSTRING_DESCRIPTOR_NODE *tail = &head;
+    ULONG                    nBytes = 0;
+
+    for (; StringDescs != NULL; StringDescs = StringDescs->Next)
+    {
+        nBytes = sizeof(STRING_DESCRIPTOR_NODE) +
+                 StringDescs->StringDescriptor->bLength;
+
+        *tail = (PSTRING_DESCRIPTOR_NODE)ALLOC(nBytes);
+
+        if (*tail == NULL)
+        {
+            FreeStringDescriptors(head);
+            return NULL;
+        }
+
+        memcpy(*tail, StringDescs, nBytes);
+        (*tail)->Next = NULL;
+        tail = &(*tail)->Next;
+    }
+
+    return head;
+}
+
+//*****************************************************************************
+//
+// FreeStringDescriptors()
+//
+//*****************************************************************************
+
+VOID
+FreeStringDescriptors (
+    _In_opt_ PSTRING_DESCRIPTOR_NODE StringDescs
+)
+{
+    PSTRING_DESCRIPTOR_NODE Next;
+
+    while (StringDescs != NULL)
+    {
+        Next = StringDescs->Next;
+        FREE(StringDescs);
+        StringDescs = Next;
+    }
+}
+
+//*****************************************************************************
+//
+// FreeCacheEntry()
+//
+//*****************************************************************************
+
+VOID
+FreeCacheEntry (
+    _In_ PDESCRIPTOR_CACHE_ENTRY Entry
+)
+{
+    if (Entry->DriverKeyName != NULL)
+    {
+        FREE(Entry->DriverKeyName);
+    }
+    if (Entry->ConfigDesc != NULL)
+    {
+        FREE(Entry->ConfigDesc);
+    }
+    if (Entry->BosDesc != NULL)
+    {
+        FREE(Entry->BosDesc);
+    }
+    FreeStringDescriptors(Entry->StringDescs);
+    FREE(Entry);
+}
+
+//*****************************************************************************
+//
+// FindCacheEntry()
+//
+// Returns the cached descriptors of a device instance.  The caller holds
+// DescriptorCacheLock.
+//
+//*****************************************************************************
+
+PDESCRIPTOR_CACHE_ENTRY
+FindCacheEntry (
+    _In_ PCHAR DriverKeyName
+)
+{
+    PLIST_ENTRY             listEntry = NULL;
+    PDESCRIPTOR_CACHE_ENTRY entry = NULL;
+
+    for (listEntry = DescriptorCacheListHead.Flink;
+         listEntry != &DescriptorCacheListHead;
+         listEntry = listEntry->Flink)
+    {
+        entry = CONTAINING_RECORD(listEntry,
+                                  DESCRIPTOR_CACHE_ENTRY,
+                                  ListEntry);
+
+        if (strcmp(DriverKeyName, entry->DriverKeyName) == 0)
+        {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+//*****************************************************************************
+//
+// LookupCachedDescriptors()
+//
+// If the device on the queried port was enumerated before with the same
+// address and device descriptor, fills Query with copies of the descriptors
+// read then, so they don't have to be requested from the device again.
+//
+// Returns TRUE if Query got the cached descriptors.
+//
+//*****************************************************************************
+
+BOOL
+LookupCachedDescriptors (
+    _Inout_ PPORT_QUERY Query
+)
+{
+    PDESCRIPTOR_CACHE_ENTRY entry = NULL;
+    BOOL                    found = FALSE;
+
+    if (Query->DriverKeyName == NULL)
+    {
+        return FALSE;
+    }
+
+    AcquireSRWLockExclusive(&DescriptorCacheLock);
+
+    entry = FindCacheEntry(Query->DriverKeyName);
+
+    if (entry != NULL &&
+        entry->DeviceAddress == Query->ConnectionInfoEx->DeviceAddress &&
+        entry->CurrentConfigurationValue == Query->ConnectionInfoEx->CurrentConfigurationValue &&
+        memcmp(&entry->DeviceDescriptor,
+               &Query->ConnectionInfoEx->DeviceDescriptor,
+               sizeof(USB_DEVICE_DESCRIPTOR)) == 0)
+    {
+        Query->ConfigDesc = CopyDescriptorRequest(entry->ConfigDesc);
+
+        if (entry->BosDesc != NULL)
+        {
+            Query->BosDesc = CopyDescriptorRequest(entry->BosDesc);
+        }
+
+        if (entry->StringDescs != NULL)
+        {
+            Query->StringDescs = CopyStringDescriptors(entry->StringDescs);
+        }
+
+        found = (Query->ConfigDesc != NULL) &&
+                (entry->BosDesc == NULL || Query->BosDesc != NULL) &&
+                (entry->StringDescs == NULL || Query->StringDescs != NULL);
+
+        if (found)
+        {
+            entry->Used = TRUE;
+        }
+    }
+
+    ReleaseSRWLockExclusive(&DescriptorCacheLock);
+
+    if (!found)
+    {
+        if (Query->ConfigDesc != NULL)
+        {
+            FREE(Query->ConfigDesc);
+            Query->ConfigDesc = NULL;
+        }
+        if (Query->BosDesc != NULL)
+        {
+            FREE(Query->BosDesc);
+            Query->BosDesc = NULL;
         }
-    } // for
+        FreeStringDescriptors(Query->StringDescs);
+        Query->StringDescs = NULL;
+    }
+
+    return found;
+}
+
+//*****************************************************************************
+//
+// CacheDescriptors()
+//
+// Keeps copies of the descriptors just read from the device on the queried
+// port, replacing what was cached for that device instance before.
+//
+//*****************************************************************************
+
+VOID
+CacheDescriptors (
+    _In_ PPORT_QUERY Query
+)
+{
+    PDESCRIPTOR_CACHE_ENTRY entry = NULL;
+    PDESCRIPTOR_CACHE_ENTRY oldEntry = NULL;
+    size_t                  cbDriverKeyName = 0;
+    HRESULT                 hr = S_OK;
+
+    if (Query->DriverKeyName == NULL || Query->ConfigDesc == NULL)
+    {
+        return;
+    }
+
+    hr = StringCbLength(Query->DriverKeyName, MAX_DRIVER_KEY_NAME, &cbDriverKeyName);
+    if (FAILED(hr))
+    {
+        return;
+    }
+
+    entry = (PDESCRIPTOR_CACHE_ENTRY)ALLOC(sizeof(DESCRIPTOR_CACHE_ENTRY));
+    if (entry == NULL)
+    {
+        OOPS();
+        return;
+    }
+
+    entry->DriverKeyName = (PCHAR)ALLOC((DWORD)cbDriverKeyName + 1);
+    entry->ConfigDesc = CopyDescriptorRequest(Query->ConfigDesc);
+    if (Query->BosDesc != NULL)
+    {
+        entry->BosDesc = CopyDescriptorRequest(Query->BosDesc);
+    }
+    if (Query->StringDescs != NULL)
+    {
+        entry->StringDescs = CopyStringDescriptors(Query->StringDescs);
+    }
+
+    if (entry->DriverKeyName == NULL ||
+        entry->ConfigDesc == NULL ||
+        (Query->BosDesc != NULL && entry->BosDesc == NULL) ||
+        (Query->StringDescs != NULL && entry->StringDescs == NULL))
+    {
+        OOPS();
+        FreeCacheEntry(entry);
+        return;
+    }
+
+    memcpy(entry->DriverKeyName, Query->DriverKeyName, cbDriverKeyName);
+    entry->DeviceAddress = Query->ConnectionInfoEx->DeviceAddress;
+    entry->CurrentConfigurationValue = Query->ConnectionInfoEx->CurrentConfigurationValue;
+    entry->DeviceDescriptor = Query->ConnectionInfoEx->DeviceDescriptor;
+    entry->Used = TRUE;
+
+    AcquireSRWLockExclusive(&DescriptorCacheLock);
+
+    oldEntry = FindCacheEntry(entry->DriverKeyName);
+    if (oldEntry != NULL)
+    {
+        RemoveEntryList(&oldEntry->ListEntry);
+    }
+
+    InsertTailList(&DescriptorCacheListHead, &entry->ListEntry);
+
+    ReleaseSRWLockExclusive(&DescriptorCacheLock);
+
+    if (oldEntry != NULL)
+    {
+        FreeCacheEntry(oldEntry);
+    }
+}
+
+//*****************************************************************************
+//
+// PruneDescriptorCache()
+//
+// Drops the cached descriptors of the devices that were not found by the
+// enumeration that just finished.
+//
+//*****************************************************************************
+
+VOID
+PruneDescriptorCache (
+    VOID
+)
+{
+    PLIST_ENTRY             listEntry = NULL;
+    PDESCRIPTOR_CACHE_ENTRY entry = NULL;
+
+    AcquireSRWLockExclusive(&DescriptorCacheLock);
+
+    listEntry = DescriptorCacheListHead.Flink;
+
+    while (listEntry != &DescriptorCacheListHead)
+    {
+        entry = CONTAINING_RECORD(listEntry,
+                                  DESCRIPTOR_CACHE_ENTRY,
+                                  ListEntry);
+
+        listEntry = listEntry->Flink;
+
+        if (entry->Used)
+        {
+            entry->Used = FALSE;
+        }
+        else
+        {
+            RemoveEntryList(&entry->ListEntry);
+            FreeCacheEntry(entry);
+        }
+    }
+
+    ReleaseSRWLockExclusive(&DescriptorCacheLock);
+}
+
+//*****************************************************************************
+//
+// FreeDescriptorCache()
+//
+//*****************************************************************************
+
+VOID
+FreeDescriptorCache (
+    VOID
+)
+{
+    PDESCRIPTOR_CACHE_ENTRY entry = NULL;
+
+    AcquireSRWLockExclusive(&DescriptorCacheLock);
+
+    while (!IsListEmpty(&DescriptorCacheListHead))
+    {
+        entry = CONTAINING_RECORD(DescriptorCacheListHead.Flink,
+                                  DESCRIPTOR_CACHE_ENTRY,
+                                  ListEntry);
+
+        RemoveEntryList(&entry->ListEntry);
+        FreeCacheEntry(entry);
+    }
+
+    ReleaseSRWLockExclusive(&DescriptorCacheLock);
 }
 
 
@@ -0,0 +1,1008 @@
+/*++
+
+Copyright (c) Microsoft Corporation
+
+Module Name:
+
+    EXPORT.C
+
+Abstract:
+
+    This source file contains the routines which write the USB tree to an
+    XML or JSON file as they walk it.
+
+    Unlike SaveXml(), which serializes an object model of the whole tree
+    built in xmlhelper.cpp, these routines write each TreeView item to a
+    file buffer as soon as they visit it, so their cost is only the
+    enumeration and the file write.  They are used by the /streamxml: and
+    /streamjson: command line options.
+
+    Each host controller, hub and port is written as a node with the same
+    properties in both formats:
+
+    XML:  <HostController Name="..." VendorId="0x8086" ...> ... </HostController>
+    JSON: {"Node":"HostController","Name":"...","VendorId":"0x8086",...,"Children":[...]}
+
+    Descriptors are written as hex strings of their raw bytes.
+
+Environment:
+
+    user mode
+
+--*/
+
+//*****************************************************************************
+// I N C L U D E S
+//*****************************************************************************
+
+#include "uvcview.h"
+#include "h264.h"
+
+//*****************************************************************************
+// D E F I N E S
+//*****************************************************************************
+
+#define EXPORT_BUFFER_SIZE      (64 * 1024)
+#define EXPORT_MAX_FORMATTED    512
+#define EXPORT_MAX_TEXT         256
+
+//*****************************************************************************
+// T Y P E D E F S
+//*****************************************************************************
+
+typedef struct _EXPORT_CONTEXT
+{
+    HANDLE      hFile;
+    BOOL        Json;
+    HRESULT     hr;
+    ULONG       Used;
+    CHAR        Buffer[EXPORT_BUFFER_SIZE];
+} EXPORT_CONTEXT, *PEXPORT_CONTEXT;
+
+//*****************************************************************************
+// L O C A L    F U N C T I O N    P R O T O T Y P E S
+//*****************************************************************************
+
+VOID
+ExportFlush (
+    _Inout_ PEXPORT_CONTEXT Context
+);
+
+VOID
+ExportWrite (
+    _Inout_ PEXPORT_CONTEXT Context,
+    _In_reads_bytes_(cbData) PCSTR Data,
+    _In_ ULONG cbData
+);
+
+VOID
+ExportPrintf (
+    _Inout_ PEXPORT_CONTEXT Context,
+    _In_ _Printf_format_string_ PCSTR Format,
+    ...
+);
+
+VOID
+ExportWriteEscaped (
+    _Inout_ PEXPORT_CONTEXT Context,
+    _In_reads_(cchText) PCWSTR Text,
+    _In_ int cchText
+);
+
+VOID
+ExportIndent (
+    _Inout_ PEXPORT_CONTEXT Context,
+    _In_ ULONG Depth
+);
+
+VOID
+ExportBeginNode (
+    _Inout_ PEXPORT_CONTEXT Context,
+    _In_ PCSTR NodeType,
+    _In_ ULONG Depth,
+    _In_ BOOL First
+);
+
+VOID
+ExportEndNode (
+    _Inout_ PEXPORT_CONTEXT Context,
+    _In_ PCSTR NodeType,
+    _In_ ULONG Depth,
+    _In_ BOOL HasChildren
+);
+
+VOID
+ExportBeginChildren (
+    _Inout_ PEXPORT_CONTEXT Context
+);
+
+VOID
+ExportPropertyString (
+    _Inout_ PEXPORT_CONTEXT Context,
+    _In_ PCSTR Name,
+    _In_opt_ PCSTR Value
+);
+
+VOID
+ExportPropertyWideString (
+    _Inout_ PEXPORT_CONTEXT Context,
+    _In_ PCSTR Name,
+    _In_reads_(cchValue) PCWSTR Value,
+    _In_ int cchValue
+);
+
+VOID
+ExportPropertyNumber (
+    _Inout_ PEXPORT_CONTEXT Context,
+    _In_ PCSTR Name,
+    _In_ ULONG Value
+);
+
+VOID
+ExportPropertyHex (
+    _Inout_ PEXPORT_CONTEXT Context,
+    _In_ PCSTR Name,
+    _In_ ULONG Value,
+    _In_ ULONG Digits
+);
+
+VOID
+ExportPropertyBytes (
+    _Inout_ PEXPORT_CONTEXT Context,
+    _In_ PCSTR Name,
+    _In_reads_bytes_(cbData) PUCHAR Data,
+    _In_ ULONG cbData
+);
+
+VOID
+ExportStringDescriptor (
+    _Inout_ PEXPORT_CONTEXT Context,
+    _In_ PCSTR Name,
+    _In_ UCHAR Index,
+    _In_opt_ PSTRING_DESCRIPTOR_NODE StringDescs
+);
+
+VOID
+ExportDeviceProperties (
+    _Inout_ PEXPORT_CONTEXT Context,
+    _In_ PVOID Info
+);
+
+PCSTR
+ExportItemProperties (
+    _Inout_ PEXPORT_CONTEXT Context,
+    _In_ HTREEITEM hTreeItem,
+    _In_ ULONG Depth,
+    _In_ BOOL First
+);
+
+VOID
+ExportItem (
+    _Inout_ PEXPORT_CONTEXT Context,
+    _In_ HTREEITEM hTreeItem,
+    _In_ ULONG Depth,
+    _In_ BOOL First
+);
+
+//*****************************************************************************
+//
+// SaveAllInformationAsStream()
+//
+// Enumerates the USB tree if it has not been yet, then writes it to
+// lpstrFileName as XML, or as JSON if Json is TRUE.
+//
+//*****************************************************************************
+
+HRESULT
+SaveAllInformationAsStream (
+    _In_ LPTSTR lpstrFileName,
+    _In_ DWORD  dwCreationDisposition,
+    _In_ BOOL   Json
+)
+{
+    PEXPORT_CONTEXT context = NULL;
+    HTREEITEM       hTreeChild = NULL;
+    CHAR            computerName[MAX_COMPUTERNAME_LENGTH + 1] = {0};
+    DWORD           cchComputerName = sizeof(computerName);
+    HRESULT         hr = S_OK;
+
+    context = (PEXPORT_CONTEXT)ALLOC(sizeof(EXPORT_CONTEXT));
+    if (context == NULL)
+    {
+        OOPS();
+        return E_OUTOFMEMORY;
+    }
+
+    context->Json = Json;
+    context->hr = S_OK;
+    context->hFile = CreateFile(lpstrFileName,
+                                GENERIC_WRITE,
+                                0,
+                                NULL,
+                                dwCreationDisposition,
+                                FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+                                NULL);
+
+    if (context->hFile == INVALID_HANDLE_VALUE)
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        FREE(context);
+        return hr;
+    }
+
+    if (GetLastError() == ERROR_ALREADY_EXISTS)
+    {
+        // CreateFile() sets this error if we are overwriting an existing file
+        // Reset this error to avoid false alarms
+        SetLastError(0);
+    }
+
+    if (ghTreeRoot == NULL)
+    {
+        // If tree has not been populated yet, try a refresh
+        RefreshTree();
+    }
+
+    if (!GetComputerName(computerName, &cchComputerName))
+    {
+        computerName[0] = '\0';
+    }
+
+    if (Json)
+    {
+        ExportPrintf(context, "{\"UsbViewVersion\":\"%d.%d\"", USBVIEW_MAJOR_VERSION, USBVIEW_MINOR_VERSION);
+        ExportPropertyString(context, "Computer", computerName);
+    }
+    else
+    {
+        ExportPrintf(context, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\r\n<UsbTree UsbViewVersion=\"%d.%d\"",
+                     USBVIEW_MAJOR_VERSION, USBVIEW_MINOR_VERSION);
+        ExportPropertyString(context, "Computer", computerName);
+    }
+
+    ExportBeginChildren(context);
+
+    // The root item is "My Computer", whose children are the host controllers
+    //
+    if (ghTreeRoot != NULL)
+    {
+        hTreeChild = TreeView_GetChild(ghTreeWnd, ghTreeRoot);
+    }
+
+    if (hTreeChild != NULL)
+    {
+        ExportItem(context, hTreeChild, 1, TRUE);
+    }
+
+    if (Json)
+    {
+        ExportWrite(context, "\r\n]}\r\n", 6);
+    }
+    else
+    {
+        ExportWrite(context, "</UsbTree>\r\n", 12);
+    }
+
+    ExportFlush(context);
+
+    hr = context->hr;
+
+    if (ghTreeRoot == NULL && SUCCEEDED(hr))
+    {
+        hr = E_FAIL;
+        OOPS();
+    }
+
+    CloseHandle(context->hFile);
+    FREE(context);
+
+    ResetTextBuffer();
+    return hr;
+}
+
+//*****************************************************************************
+//
+// ExportItem()
+//
+// Writes hTreeItem, its children and its following siblings.
+//
+//*****************************************************************************
+
+VOID
+ExportItem (
+    _Inout_ PEXPORT_CONTEXT Context,
+    _In_ HTREEITEM hTreeItem,
+    _In_ ULONG Depth,
+    _In_ BOOL First
+)
+{
+    HTREEITEM hTreeChild = NULL;
+    PCSTR     nodeType = NULL;
+
+    for (; hTreeItem != NULL && SUCCEEDED(Context->hr); First = FALSE)
+    {
+        nodeType = ExportItemProperties(Context, hTreeItem, Depth, First);
+
+        hTreeChild = TreeView_GetChild(ghTreeWnd, hTreeItem);
+
+        if (hTreeChild != NULL)
+        {
+            ExportBeginChildren(Context);
+            ExportItem(Context, hTreeChild, Depth + 1, TRUE);
+        }
+
+        ExportEndNode(Context, nodeType, Depth, hTreeChild != NULL);
+
+        hTreeItem = TreeView_GetNextSibling(ghTreeWnd, hTreeItem);
+    }
+}
+
+//*****************************************************************************
+//
+// ExportItemProperties()
+//
+// Begins the node of hTreeItem and writes its properties.  Returns the node
+// type, which ExportEndNode() needs to close an XML element.
+//
+//*****************************************************************************
+
+PCSTR
+ExportItemProperties (
+    _Inout_ PEXPORT_CONTEXT Context,
+    _In_ HTREEITEM hTreeItem,
+    _In_ ULONG Depth,
+    _In_ BOOL First
+)
+{
+    TV_ITEM tvi;
+    CHAR    tviName[EXPORT_MAX_TEXT] = {0};
+    PVOID   info = NULL;
+    PCSTR   nodeType = "Item";
+
+    tvi.mask = TVIF_HANDLE | TVIF_TEXT | TVIF_PARAM;
+    tvi.hItem = hTreeItem;
+    tvi.pszText = (LPSTR) tviName;
+    tvi.cchTextMax = sizeof(tviName);
+    tvi.lParam = 0;
+
+    TreeView_GetItem(ghTreeWnd,
+            &tvi);
+
+    info = (PVOID)tvi.lParam;
+
+    if (info != NULL)
+    {
+        switch (*(PUSBDEVICEINFOTYPE)info)
+        {
+            case HostControllerInfo:
+                nodeType = "HostController";
+                break;
+
+            case RootHubInfo:
+                nodeType = "RootHub";
+                break;
+
+            case ExternalHubInfo:
+                nodeType = "ExternalHub";
+                break;
+
+            case DeviceInfo:
+                nodeType = "UsbDevice";
+                if (((PUSBDEVICEINFO)info)->ConnectionInfo->ConnectionStatus == NoDeviceConnected)
+                {
+                    nodeType = "EmptyPort";
+                }
+                break;
+        }
+    }
+
+    ExportBeginNode(Context, nodeType, Depth, First);
+    ExportPropertyString(Context, "Name", tviName);
+
+    if (info != NULL)
+    {
+        ExportDeviceProperties(Context, info);
+    }
+
+    return nodeType;
+}
+
+//*****************************************************************************
+//
+// ExportDeviceProperties()
+//
+// Writes what was collected about a host controller, hub or port during
+// enumeration.
+//
+//*****************************************************************************
+
+VOID
+ExportDeviceProperties (
+    _Inout_ PEXPORT_CONTEXT Context,
+    _In_ PVOID Info
+)
+{
+    PUSBHOSTCONTROLLERINFO              hcInfo = NULL;
+    PUSBROOTHUBINFO                     rhInfo = NULL;
+    PUSBDEVICEINFO                      devInfo = NULL;
+    PUSB_NODE_CONNECTION_INFORMATION_EX connectionInfo = NULL;
+    PUSB_DEVICE_PNP_STRINGS             devProps = NULL;
+    PUSB_CONFIGURATION_DESCRIPTOR       configDesc = NULL;
+    PUSB_BOS_DESCRIPTOR                 bosDesc = NULL;
+
+    switch (*(PUSBDEVICEINFOTYPE)Info)
+    {
+        case HostControllerInfo:
+            hcInfo = (PUSBHOSTCONTROLLERINFO)Info;
+
+            ExportPropertyString(Context, "DriverKey", hcInfo->DriverKey);
+            ExportPropertyHex(Context, "VendorId", hcInfo->VendorID, 4);
+            ExportPropertyHex(Context, "DeviceId", hcInfo->DeviceID, 4);
+            ExportPropertyHex(Context, "SubSysId", hcInfo->SubSysID, 8);
+            ExportPropertyHex(Context, "Revision", hcInfo->Revision, 2);
+
+            if (hcInfo->BusDeviceFunctionValid)
+            {
+                ExportPropertyNumber(Context, "BusNumber", hcInfo->BusNumber);
+                ExportPropertyNumber(Context, "BusDevice", hcInfo->BusDevice);
+                ExportPropertyNumber(Context, "BusFunction", hcInfo->BusFunction);
+            }
+
+            devProps = hcInfo->UsbDeviceProperties;
+            break;
+
+        case RootHubInfo:
+            rhInfo = (PUSBROOTHUBINFO)Info;
+
+            ExportPropertyString(Context, "HubName", rhInfo->HubName);
+            ExportPropertyNumber(Context, "NumberOfPorts",
+                                 rhInfo->HubInfo->u.HubInformation.HubDescriptor.bNumberOfPorts);
+
+            devProps = rhInfo->UsbDeviceProperties;
+            break;
+
+        case ExternalHubInfo:
+        case DeviceInfo:
+            // USBEXTERNALHUBINFO has the same layout as USBDEVICEINFO
+            //
+            devInfo = (PUSBDEVICEINFO)Info;
+            connectionInfo = devInfo->ConnectionInfo;
+
+            ExportPropertyNumber(Context, "Port", connectionInfo->ConnectionIndex);
+            ExportPropertyNumber(Context, "ConnectionStatus", connectionInfo->ConnectionStatus);
+
+            if (devInfo->HubName != NULL)
+            {
+                ExportPropertyString(Context, "HubName", devInfo->HubName);
+                ExportPropertyNumber(Context, "NumberOfPorts",
+                                     devInfo->HubInfo->u.HubInformation.HubDescriptor.bNumberOfPorts);
+            }
+
+            if (connectionInfo->ConnectionStatus == NoDeviceConnected)
+            {
+                break;
+            }
+
+            ExportPropertyNumber(Context, "Speed", connectionInfo->Speed);
+            ExportPropertyNumber(Context, "DeviceAddress", connectionInfo->DeviceAddress);
+            ExportPropertyNumber(Context, "CurrentConfigurationValue", connectionInfo->CurrentConfigurationValue);
+            ExportPropertyHex(Context, "VendorId", connectionInfo->DeviceDescriptor.idVendor, 4);
+            ExportPropertyHex(Context, "ProductId", connectionInfo->DeviceDescriptor.idProduct, 4);
+            ExportPropertyHex(Context, "BcdDevice", connectionInfo->DeviceDescriptor.bcdDevice, 4);
+            ExportPropertyHex(Context, "BcdUsb", connectionInfo->DeviceDescriptor.bcdUSB, 4);
+            ExportPropertyHex(Context, "DeviceClass", connectionInfo->DeviceDescriptor.bDeviceClass, 2);
+            ExportPropertyHex(Context, "DeviceSubClass", connectionInfo->DeviceDescriptor.bDeviceSubClass, 2);
+            ExportPropertyHex(Context, "DeviceProtocol", connectionInfo->DeviceDescriptor.bDeviceProtocol, 2);
+
+            ExportStringDescriptor(Context, "Manufacturer",
+                                   connectionInfo->DeviceDescriptor.iManufacturer,
+                                   devInfo->StringDescs);
+            ExportStringDescriptor(Context, "Product",
+                                   connectionInfo->DeviceDescriptor.iProduct,
+                                   devInfo->StringDescs);
+            ExportStringDescriptor(Context, "SerialNumber",
+                                   connectionInfo->DeviceDescriptor.iSerialNumber,
+                                   devInfo->StringDescs);
+
+            ExportPropertyBytes(Context, "DeviceDescriptor",
+                                (PUCHAR)&connectionInfo->DeviceDescriptor,
+                                sizeof(USB_DEVICE_DESCRIPTOR));
+
+            if (devInfo->ConfigDesc != NULL)
+            {
+                configDesc = (PUSB_CONFIGURATION_DESCRIPTOR)(devInfo->ConfigDesc + 1);
+                ExportPropertyBytes(Context, "ConfigurationDescriptor",
+                                    (PUCHAR)configDesc,
+                                    configDesc->wTotalLength);
+            }
+
+            if (devInfo->BosDesc != NULL)
+            {
+                bosDesc = (PUSB_BOS_DESCRIPTOR)(devInfo->BosDesc + 1);
+                ExportPropertyBytes(Context, "BosDescriptor",
+                                    (PUCHAR)bosDesc,
+                                    bosDesc->wTotalLength);
+            }
+
+            devProps = devInfo->UsbDeviceProperties;
+            break;
+    }
+
+    if (devProps != NULL)
+    {
+        ExportPropertyString(Context, "PnpDeviceId", devProps->DeviceId);
+        ExportPropertyString(Context, "Service", devProps->Service);
+        ExportPropertyString(Context, "DeviceClassName", devProps->DeviceClass);
+    }
+}
+
+//*****************************************************************************
+//
+// ExportStringDescriptor()
+//
+// Writes string descriptor Index, in US English if the device has it, or
+// else in the first language it was read in.
+//
+//*****************************************************************************
+
+VOID
+ExportStringDescriptor (
+    _Inout_ PEXPORT_CONTEXT Context,
+    _In_ PCSTR Name,
+    _In_ UCHAR Index,
+    _In_opt_ PSTRING_DESCRIPTOR_NODE StringDescs
+)
+{
+    PSTRING_DESCRIPTOR_NODE found = NULL;
+
+    if (Index == 0)
+    {
+        return;
+    }
+
+    for (; StringDescs != NULL; StringDescs = StringDescs->Next)
+    {
+        if (StringDescs->DescriptorIndex == Index)
+        {
+            if (found == NULL || StringDescs->LanguageID == 0x0409)
+            {
+                found = StringDescs;
+            }
+        }
+    }
+
+    if (found != NULL && found->StringDescriptor->bLength >= 2)
+    {
+        ExportPropertyWideString(Context,
+                                 Name,
+                                 found->StringDescriptor->bString,
+                                 (found->StringDescriptor->bLength - 2) / sizeof(WCHAR));
+    }
+}
+
+//*****************************************************************************
+//
+// ExportBeginNode()
+// ExportBeginChildren()
+// ExportEndNode()
+//
+// A node's properties are written between ExportBeginNode() and
+// ExportBeginChildren(), its children between ExportBeginChildren() and
+// ExportEndNode().
+//
+//*****************************************************************************
+
+VOID
+ExportBeginNode (
+    _Inout_ PEXPORT_CONTEXT Context,
+    _In_ PCSTR NodeType,
+    _In_ ULONG Depth,
+    _In_ BOOL First
+)
+{
+    if (Context->Json)
+    {
+        ExportWrite(Context, First ? "\r\n" : ",\r\n", First ? 2 : 3);
+        ExportIndent(Context, Depth);
+        ExportPrintf(Context, "{\"Node\":\"%s\"", NodeType);
+    }
+    else
+    {
+        ExportIndent(Context, Depth);
+        ExportPrintf(Context, "<%s", NodeType);
+    }
+}
+
+VOID
+ExportBeginChildren (
+    _Inout_ PEXPORT_CONTEXT Context
+)
+{
+    if (Context->Json)
+    {
+        ExportWrite(Context, ",\"Children\":[", 13);
+    }
+    else
+    {
+        ExportWrite(Context, ">\r\n", 3);
+    }
+}
+
+VOID
+ExportEndNode (
+    _Inout_ PEXPORT_CONTEXT Context,
+    _In_ PCSTR NodeType,
+    _In_ ULONG Depth,
+    _In_ BOOL HasChildren
+)
+{
+    if (Context->Json)
+    {
+        if (HasChildren)
+        {
+            ExportWrite(Context, "\r\n", 2);
+            ExportIndent(Context, Depth);
+            ExportWrite(Context, "]", 1);
+        }
+        ExportWrite(Context, "}", 1);
+    }
+    else if (HasChildren)
+    {
+        ExportIndent(Context, Depth);
+        ExportPrintf(Context, "</%s>\r\n", NodeType);
+    }
+    else
+    {
+        ExportWrite(Context, "/>\r\n", 4);
+    }
+}
+
+//*****************************************************************************
+//
+// ExportProperty*()
+//
+// Write a property of the current node, as an attribute in XML.
+//
+//*****************************************************************************
+
+VOID
+ExportPropertyString (
+    _Inout_ PEXPORT_CONTEXT Context,
+    _In_ PCSTR Name,
+    _In_opt_ PCSTR Value
+)
+{
+    WCHAR   wideValue[EXPORT_MAX_TEXT];
+    int     cchWideValue = 0;
+
+    if (Value == NULL)
+    {
+        return;
+    }
+
+    // The strings we collect are in the ANSI code page, the file is UTF-8
+    //
+    cchWideValue = MultiByteToWideChar(CP_ACP,
+                                       0,
+                                       Value,
+                                       -1,
+                                       wideValue,
+                                       EXPORT_MAX_TEXT);
+    if (cchWideValue <= 0)
+    {
+        // Too long, cut it short
+        wideValue[EXPORT_MAX_TEXT - 1] = L'\0';
+        cchWideValue = (int)wcslen(wideValue) + 1;
+    }
+
+    ExportPropertyWideString(Context, Name, wideValue, cchWideValue - 1);
+}
+
+VOID
+ExportPropertyWideString (
+    _Inout_ PEXPORT_CONTEXT Context,
+    _In_ PCSTR Name,
+    _In_reads_(cchValue) PCWSTR Value,
+    _In_ int cchValue
+)
+{
+    if (Context->Json)
+    {
+        ExportPrintf(Context, ",\"%s\":\"", Name);
+    }
+    else
+    {
+        ExportPrintf(Context, " %s=\"", Name);
+    }
+
+    ExportWriteEscaped(Context, Value, cchValue);
+    ExportWrite(Context, "\"", 1);
+}
+
+VOID
+ExportPropertyNumber (
+    _Inout_ PEXPORT_CONTEXT Context,
+    _In_ PCSTR Name,
+    _In_ ULONG Value
+)
+{
+    if (Context->Json)
+    {
+        ExportPrintf(Context, ",\"%s\":%u", Name, Value);
+    }
+    else
+    {
+        ExportPrintf(Context, " %s=\"%u\"", Name, Value);
+    }
+}
+
+VOID
+ExportPropertyHex (
+    _Inout_ PEXPORT_CONTEXT Context,
+    _In_ PCSTR Name,
+    _In_ ULONG Value,
+    _In_ ULONG Digits
+)
+{
+    if (Context->Json)
+    {
+        ExportPrintf(Context, ",\"%s\":\"0x%0*X\"", Name, Digits, Value);
+    }
+    else
+    {
+        ExportPrintf(Context, " %s=\"0x%0*X\"", Name, Digits, Value);
+    }
+}
+
+VOID
+ExportPropertyBytes (
+    _Inout_ PEXPORT_CONTEXT Context,
+    _In_ PCSTR Name,
+    _In_reads_bytes_(cbData) PUCHAR Data,
+    _In_ ULONG cbData
+)
+{
+    static const CHAR hexDigits[] = "0123456789ABCDEF";
+    CHAR    hex[2];
+    ULONG   i = 0;
+
+    if (Context->Json)
+    {
+        ExportPrintf(Context, ",\"%s\":\"", Name);
+    }
+    else
+    {
+        ExportPrintf(Context, " %s=\"", Name);
+    }
+
+    for (i = 0; i < cbData; i++)
+    {
+        hex[0] = hexDigits[Data[i] >> 4];
+        hex[1] = hexDigits[Data[i] & 0xF];
+        ExportWrite(Context, hex, 2);
+    }
+
+    ExportWrite(Context, "\"", 1);
+}
+
+//*****************************************************************************
+//
+// ExportWriteEscaped()
+//
+// Writes Text as UTF-8, escaped for an XML attribute or a JSON string.
+//
+//*****************************************************************************
+
+VOID
+ExportWriteEscaped (
+    _Inout_ PEXPORT_CONTEXT Context,
+    _In_reads_(cchText) PCWSTR Text,
+    _In_ int cchText
+)
+{
+    CHAR    utf8[8];
+    int     cbUtf8 = 0;
+    int     i = 0;
+    WCHAR   c = 0;
+
+    for (i = 0; i < cchText; i++)
+    {
+        c = Text[i];
+
+        if (c == L'\0')
+        {
+            break;
+        }
+
+        if (c == L'"')
+        {
+            if (Context->Json)
+            {
+                ExportWrite(Context, "\\\"", 2);
+            }
+            else
+            {
+                ExportWrite(Context, "&quot;", 6);
+            }
+        }
+        else if (c == L'&' && !Context->Json)
+        {
+            ExportWrite(Context, "&amp;", 5);
+        }
+        else if (c == L'<' && !Context->Json)
+        {
+            ExportWrite(Context, "&lt;", 4);
+        }
+        else if (c == L'>' && !Context->Json)
+        {
+            ExportWrite(Context, "&gt;", 4);
+        }
+        else if (c == L'\\' && Context->Json)
+        {
+            ExportWrite(Context, "\\\\", 2);
+        }
+        else if (c < L' ')
+        {
+            if (Context->Json)
+            {
+                ExportPrintf(Context, "\\u%04X", c);
+            }
+            else if (c == L'\t' || c == L'\n' || c == L'\r')
+            {
+                ExportPrintf(Context, "&#x%X;", c);
+            }
+            else
+            {
+                // Not allowed in xml 1.0, even as a character reference
+                ExportWrite(Context, "?", 1);
+            }
+        }
+        else if (c < 0x80)
+        {
+            utf8[0] = (CHAR)c;
+            ExportWrite(Context, utf8, 1);
+        }
+        else
+        {
+            // Keep surrogate pairs together
+            //
+            cbUtf8 = WideCharToMultiByte(CP_UTF8,
+                                         0,
+                                         &Text[i],
+                                         (IS_HIGH_SURROGATE(c) && i + 1 < cchText) ? 2 : 1,
+                                         utf8,
+                                         sizeof(utf8),
+                                         NULL,
+                                         NULL);
+            if (cbUtf8 > 0)
+            {
+                ExportWrite(Context, utf8, cbUtf8);
+            }
+
+            if (IS_HIGH_SURROGATE(c) && i + 1 < cchText)
+            {
+                i++;
+            }
+        }
+    }
+}
+
+//*****************************************************************************
+//
+// ExportIndent()
+//
+//*****************************************************************************
+
+VOID
+ExportIndent (
+    _Inout_ PEXPORT_CONTEXT Context,
+    _In_ ULONG Depth
+)
+{
+    ULONG i = 0;
+
+    for (i = 0; i < Depth; i++)
+    {
+        ExportWrite(Context, "  ", 2);
+    }
+}
+
+//*****************************************************************************
+//
+// ExportPrintf()
+//
+//*****************************************************************************
+
+VOID
+ExportPrintf (
+    _Inout_ PEXPORT_CONTEXT Context,
+    _In_ _Printf_format_string_ PCSTR Format,
+    ...
+)
+{
+    CHAR    formatted[EXPORT_MAX_FORMATTED];
+    size_t  cbFormatted = 0;
+    va_list args;
+
+    va_start(args, Format);
+
+    // A truncated string is still written
+    //
+    StringCbVPrintf(formatted, sizeof(formatted), Format, args);
+
+    va_end(args);
+
+    if (SUCCEEDED(StringCbLength(formatted, sizeof(formatted), &cbFormatted)))
+    {
+        ExportWrite(Context, formatted, (ULONG)cbFormatted);
+    }
+}
+
+//*****************************************************************************
+//
+// ExportWrite()
+//
+// Appends to the file buffer, and writes the buffer to the file when it
+// fills up.  After a write failed, Context->hr holds the error and nothing
+// more is written.
+//
+//*****************************************************************************
+
+VOID
+ExportWrite (
+    _Inout_ PEXPORT_CONTEXT Context,
+    _In_reads_bytes_(cbData) PCSTR Data,
+    _In_ ULONG cbData
+)
+{
+    ULONG cbCopy = 0;
+
+    while (cbData > 0 && SUCCEEDED(Context->hr))
+    {
+        if (Context->Used == EXPORT_BUFFER_SIZE)
+        {
+            ExportFlush(Context);
+            continue;
+        }
+
+        cbCopy = min(cbData, EXPORT_BUFFER_SIZE - Context->Used);
+        memcpy(&Context->Buffer[Context->Used], Data, cbCopy);
+        Context->Used += cbCopy;
+        Data += cbCopy;
+        cbData -= cbCopy;
+    }
+}
+
+//*****************************************************************************
+//
+// ExportFlush()
+//
+//*****************************************************************************
+
+VOID
+ExportFlush (
+    _Inout_ PEXPORT_CONTEXT Context
+)
+{
+    DWORD dwBytesWritten = 0;
+
+    if (Context->Used > 0 && SUCCEEDED(Context->hr))
+    {
+        if (!WriteFile(Context->hFile,
+                       Context->Buffer,
+                       Context->Used,
+                       &dwBytesWritten,
+                       NULL) ||
+            dwBytesWritten != Context->Used)
+        {
+            Context->hr = HRESULT_FROM_WIN32(GetLastError());
+            if (SUCCEEDED(Context->hr))
+            {
+                Context->hr = E_FAIL;
+            }
+            OOPS();
+        }
+    }
+
+    Context->Used = 0;
+}
@@ -32,6 +32,8 @@ Copyright (c) 1998-2008 Microsoft Corporation, All Rights Reserved.
 #define IDS_USBVIEW_INTERNAL_ERROR      2009
 #define IDS_USBVIEW_SAVED_TO            2010
 #define IDS_USBVIEW_INVALID_FILENAME    2011
+#define IDS_USBVIEW_FILE_EXISTS_STREAMXML 2012
+#define IDS_USBVIEW_FILE_EXISTS_JSON    2013
 
 #define IDC_VERSION                     3000
 #define IDC_UVCVERSION                  3001
@@ -64,7 +64,9 @@ typedef enum _USBVIEW_SAVE_FILE_TYPE
 {
     UsbViewNone = 0,
     UsbViewXmlFile,
-    UsbViewTxtFile
+    UsbViewTxtFile,
+    UsbViewStreamXmlFile,
+    UsbViewJsonFile
 } USBVIEW_SAVE_FILE_TYPE;
 
 /*****************************************************************************
@@ -335,6 +337,8 @@ WinMain (
 
     ReleaseXmlWriter();
 
+    FreeDescriptorCache();
+
     CHECKFORLEAKS();
 
     return retStatus;
@@ -403,6 +407,14 @@ BOOL ProcessCommandLine()
             {
                 fileType = UsbViewXmlFile;
             }
+            else if (NULL != StrStrI(szAnsiArg, "/streamxml:"))
+            {
+                fileType = UsbViewStreamXmlFile;
+            }
+            else if (NULL != StrStrI(szAnsiArg, "/streamjson:"))
+            {
+                fileType = UsbViewJsonFile;
+            }
             else if (0 == _stricmp(szAnsiArg, "/f"))
             {
                 dwCreationDisposition = CREATE_ALWAYS;
@@ -498,6 +510,12 @@ HRESULT ProcessCommandSaveFile(LPTSTR szFileName, DWORD dwCreationDisposition, U
         hr = SaveAllInformationAsText(szFileName, dwCreationDisposition);
     }
 
+    if (UsbViewStreamXmlFile == fileType || UsbViewJsonFile == fileType)
+    {
+        // Written straight from the tree, without building the xml document
+        hr = SaveAllInformationAsStream(szFileName, dwCreationDisposition, UsbViewJsonFile == fileType);
+    }
+
     if (FAILED(hr))
     {
         if (GetLastError() == ERROR_FILE_EXISTS || hr == HRESULT_FROM_WIN32(ERROR_FILE_EXISTS))
@@ -512,6 +530,12 @@ HRESULT ProcessCommandSaveFile(LPTSTR szFileName, DWORD dwCreationDisposition, U
                 case UsbViewTxtFile:
                     DisplayMessage(IDS_USBVIEW_FILE_EXISTS_TXT, szFileName);
                     break;
+                case UsbViewStreamXmlFile:
+                    DisplayMessage(IDS_USBVIEW_FILE_EXISTS_STREAMXML, szFileName);
+                    break;
+                case UsbViewJsonFile:
+                    DisplayMessage(IDS_USBVIEW_FILE_EXISTS_JSON, szFileName);
+                    break;
                 default:
                     DisplayMessage(IDS_USBVIEW_INTERNAL_ERROR);
                     break;
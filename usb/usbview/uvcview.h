@@ -376,6 +376,8 @@ BOOL gDoConfigDesc;
 BOOL gDoAnnotation;
 BOOL gLogDebug;
 int  TotalHubs;
+HWND ghTreeWnd;
+HTREEITEM ghTreeRoot;
 
 //
 // ENUM.C
@@ -579,6 +581,11 @@ CleanupItem (
     PVOID pContext
     );
 
+VOID
+FreeDescriptorCache (
+    VOID
+    );
+
 DEVICE_POWER_STATE
 AcquireDevicePowerState(
     _Inout_ PDEVICE_INFO_NODE pNode
@@ -644,6 +651,17 @@ VOID FreeDeviceProperties(
         _In_ PUSB_DEVICE_PNP_STRINGS *ppDevProps
         );
 //
+// EXPORT.C
+//
+
+HRESULT
+SaveAllInformationAsStream (
+    _In_ LPTSTR lpstrFileName,
+    _In_ DWORD  dwCreationDisposition,
+    _In_ BOOL   Json
+    );
+
+//
 // DISPAUD.C
 //
 
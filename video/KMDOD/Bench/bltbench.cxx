@@ -0,0 +1,316 @@
+/******************************Module*Header*******************************\
+ * Module Name: BltBench.cxx
+ *
+ * A benchmark for the row conversions of CopyBitsConvert32
+ *
+ * CopyBitsConvert32 converts each row of a 32bpp source to a 24bpp or
+ * 16bpp frame buffer with ConvertRow32To24 or ConvertRow32To16, which use
+ * SSE2 on x64. The benchmark times both against the byte at a time loops
+ * they replaced, for the row widths of common modes at a 16 byte aligned
+ * and an unaligned start pixel, and checks that each gives the same output
+ * as its loop, and writes nothing past the end of the row.
+ *
+ * It builds BltConvert.cxx from the driver directory, so it runs the same
+ * code the driver does. The rows are in cached memory; the frame buffer
+ * the driver writes is write-combined, which makes its stores slower.
+ *
+ * Environment:
+ *
+ *     User mode
+ *
+ * Copyright (c) 2010 Microsoft Corporation
+\**************************************************************************/
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_code_)
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "BltConvert.hxx"
+
+#define DEFAULT_MILLISECONDS    200
+
+// Bytes past the end of a destination row that must be left alone
+#define GUARD_BYTES             32
+#define GUARD_FILL              0xCD
+
+// Every width up to this is checked, to cover each tail the kernels can leave
+#define CHECK_MAX_PIXELS        64
+
+typedef VOID (*PCONVERT_ROUTINE)(BYTE* pDst, CONST BYTE* pSrc, UINT NumPixels);
+
+typedef struct _BENCH_ROUTINE
+{
+    PCSTR Name;
+    UINT DstBytesPerPixel;
+    PCONVERT_ROUTINE Baseline;
+    PCONVERT_ROUTINE Routine;
+} BENCH_ROUTINE;
+
+// Row widths of 1024x768, 1366x768, 1920x1080 and 3840x2160, and a narrow dirty rect
+CONST UINT Widths[] = { 7, 64, 1024, 1366, 1920, 3840 };
+
+// A 16 byte aligned start pixel, and one that makes every load unaligned
+CONST UINT Offsets[] = { 0, 1 };
+
+LARGE_INTEGER Frequency;
+
+
+/****************************Internal*Routine******************************\
+ * The loops CopyBitsConvert32 used before the row kernels
+\**************************************************************************/
+
+VOID Convert24Bytes(BYTE* pDst, CONST BYTE* pSrc, UINT NumPixels)
+{
+    for (UINT i = 0; i < NumPixels; i++)
+    {
+        pDst[i * 3 + 0] = pSrc[i * 4 + 0];
+        pDst[i * 3 + 1] = pSrc[i * 4 + 1];
+        pDst[i * 3 + 2] = pSrc[i * 4 + 2];
+    }
+}
+
+VOID Convert16Macro(BYTE* pDst, CONST BYTE* pSrc, UINT NumPixels)
+{
+    for (UINT i = 0; i < NumPixels; i++)
+    {
+        CONST BYTE* pPixel = &pSrc[i * 4];
+        ((UINT16*)pDst)[i] = (UINT16)CONVERT_32BPP_TO_16BPP(pPixel);
+    }
+}
+
+VOID Convert24Row(BYTE* pDst, CONST BYTE* pSrc, UINT NumPixels)
+{
+    ConvertRow32To24(pDst, pSrc, NumPixels);
+}
+
+VOID Convert16Row(BYTE* pDst, CONST BYTE* pSrc, UINT NumPixels)
+{
+    ConvertRow32To16((UINT16*)pDst, (CONST UINT32*)pSrc, NumPixels);
+}
+
+CONST BENCH_ROUTINE Routines[] = {
+    { "24bpp", 3, Convert24Bytes, Convert24Row },
+    { "16bpp", 2, Convert16Macro, Convert16Row },
+};
+
+
+VOID FillRow(_Out_writes_bytes_(Length) BYTE* pBuffer, UINT Length)
+{
+    ULONG Seed = 0x12345678;
+
+    for (UINT i = 0; i < Length; i++)
+    {
+        Seed = Seed * 1664525 + 1013904223;
+        pBuffer[i] = (BYTE)(Seed >> 24);
+    }
+}
+
+/****************************Internal*Routine******************************\
+ * CheckRoutine
+ *
+ *
+ * Converts the same row with the routine and with its baseline loop and
+ * compares the results byte for byte, including the guard bytes after the
+ * row, which neither may touch.
+ *
+\**************************************************************************/
+
+BOOLEAN CheckRoutine(
+    CONST BENCH_ROUTINE* pRoutine,
+    UINT NumPixels,
+    UINT Offset,
+    CONST BYTE* pSrc,
+    BYTE* pExpected,
+    BYTE* pActual)
+{
+    UINT Length = NumPixels * pRoutine->DstBytesPerPixel + GUARD_BYTES;
+
+    memset(pExpected, GUARD_FILL, Length);
+    memset(pActual, GUARD_FILL, Length);
+
+    pRoutine->Baseline(pExpected, pSrc + Offset * 4, NumPixels);
+    pRoutine->Routine(pActual, pSrc + Offset * 4, NumPixels);
+
+    for (UINT i = NumPixels * pRoutine->DstBytesPerPixel; i < Length; i++)
+    {
+        if (pActual[i] != GUARD_FILL)
+        {
+            return FALSE;
+        }
+    }
+
+    return (memcmp(pExpected, pActual, Length) == 0);
+}
+
+/****************************Internal*Routine******************************\
+ * TimeRoutine
+ *
+ *
+ * Returns the average time of one row in nanoseconds.
+ *
+\**************************************************************************/
+
+double TimeRoutine(
+    PCONVERT_ROUTINE Routine,
+    UINT NumPixels,
+    UINT Offset,
+    CONST BYTE* pSrc,
+    BYTE* pDst,
+    ULONG Milliseconds)
+{
+    LARGE_INTEGER Start;
+    LARGE_INTEGER Now;
+    LONGLONG Budget;
+    ULONGLONG Calls = 0;
+    UINT i;
+
+    // Warm up the caches and the branch predictors
+    for (i = 0; i < 16; i++)
+    {
+        Routine(pDst, pSrc + Offset * 4, NumPixels);
+    }
+
+    Budget = Frequency.QuadPart * Milliseconds / 1000;
+
+    QueryPerformanceCounter(&Start);
+
+    do
+    {
+        for (i = 0; i < 16; i++)
+        {
+            Routine(pDst, pSrc + Offset * 4, NumPixels);
+        }
+
+        Calls += 16;
+
+        QueryPerformanceCounter(&Now);
+
+    } while (Now.QuadPart - Start.QuadPart < Budget);
+
+    return (double)(Now.QuadPart - Start.QuadPart) * 1e9 / (double)Frequency.QuadPart / (double)Calls;
+}
+
+VOID Usage()
+{
+    printf("Usage: BltBench [-Milliseconds <n>]\n");
+    printf("    -Milliseconds   time spent on each case (default %d)\n", DEFAULT_MILLISECONDS);
+}
+
+int __cdecl main(
+    _In_ int argc,
+    _In_reads_(argc) char* argv[])
+{
+    ULONG Milliseconds = DEFAULT_MILLISECONDS;
+    UINT MaxPixels = Widths[ARRAYSIZE(Widths) - 1] + 1;
+    BYTE* pSrc;
+    BYTE* pExpected;
+    BYTE* pActual;
+    int Failures = 0;
+    double Baseline;
+    double Time;
+
+    for (int Argument = 1; Argument < argc; Argument++)
+    {
+        if ((_stricmp(argv[Argument], "-Milliseconds") == 0) && (Argument + 1 < argc))
+        {
+            Milliseconds = strtoul(argv[++Argument], NULL, 0);
+        }
+        else
+        {
+            Usage();
+            return 1;
+        }
+    }
+
+    if (Milliseconds == 0)
+    {
+        Usage();
+        return 1;
+    }
+
+    pSrc = (BYTE*)VirtualAlloc(NULL, MaxPixels * 4, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    pExpected = (BYTE*)VirtualAlloc(NULL, MaxPixels * 3 + GUARD_BYTES, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    pActual = (BYTE*)VirtualAlloc(NULL, MaxPixels * 3 + GUARD_BYTES, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+    if ((pSrc == NULL) || (pExpected == NULL) || (pActual == NULL))
+    {
+        printf("Out of memory\n");
+        return 1;
+    }
+
+    FillRow(pSrc, MaxPixels * 4);
+
+    QueryPerformanceFrequency(&Frequency);
+
+    // Keep the timing thread on one processor and ahead of the rest of the system
+    SetThreadAffinityMask(GetCurrentThread(), 1);
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+
+#if defined(_M_X64)
+    printf("Row kernels: SSE2\n\n");
+#else
+    printf("Row kernels: portable\n\n");
+#endif // _M_X64
+
+    for (UINT r = 0; r < ARRAYSIZE(Routines); r++)
+    {
+        for (UINT n = 0; n <= CHECK_MAX_PIXELS; n++)
+        {
+            for (UINT o = 0; o < ARRAYSIZE(Offsets); o++)
+            {
+                if (!CheckRoutine(&Routines[r], n, Offsets[o], pSrc, pExpected, pActual))
+                {
+                    printf("%-6s %-6s %6u %6u    MISMATCH against the byte loop\n",
+                           Routines[r].Name, "Row", n, Offsets[o]);
+                    Failures++;
+                }
+            }
+        }
+    }
+
+    printf("%-6s %-6s %6s %6s %12s %8s %8s\n",
+           "Format", "Kernel", "Pixels", "Offset", "ns/row", "GB/s", "vs C");
+
+    for (UINT r = 0; r < ARRAYSIZE(Routines); r++)
+    {
+        for (UINT w = 0; w < ARRAYSIZE(Widths); w++)
+        {
+            for (UINT o = 0; o < ARRAYSIZE(Offsets); o++)
+            {
+                if (!CheckRoutine(&Routines[r], Widths[w], Offsets[o], pSrc, pExpected, pActual))
+                {
+                    printf("%-6s %-6s %6u %6u    MISMATCH against the byte loop\n",
+                           Routines[r].Name, "Row", Widths[w], Offsets[o]);
+                    Failures++;
+                    continue;
+                }
+
+                Baseline = TimeRoutine(Routines[r].Baseline, Widths[w], Offsets[o], pSrc, pActual, Milliseconds);
+                Time = TimeRoutine(Routines[r].Routine, Widths[w], Offsets[o], pSrc, pActual, Milliseconds);
+
+                // GB/s counts the 32bpp source bytes read
+                printf("%-6s %-6s %6u %6u %12.1f %8.2f %7.2fx\n",
+                       Routines[r].Name, "C", Widths[w], Offsets[o],
+                       Baseline, Widths[w] * 4 / Baseline, 1.0);
+                printf("%-6s %-6s %6u %6u %12.1f %8.2f %7.2fx\n",
+                       Routines[r].Name, "Row", Widths[w], Offsets[o],
+                       Time, Widths[w] * 4 / Time, Baseline / Time);
+            }
+        }
+    }
+
+    VirtualFree(pSrc, 0, MEM_RELEASE);
+    VirtualFree(pExpected, 0, MEM_RELEASE);
+    VirtualFree(pActual, 0, MEM_RELEASE);
+
+    if (Failures != 0)
+    {
+        printf("\n%d row checks failed\n", Failures);
+        return 2;
+    }
+
+    return 0;
+}
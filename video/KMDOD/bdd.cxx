@@ -112,6 +112,8 @@ VOID BASIC_DISPLAY_DRIVER::CleanUp()
     {
         if (m_CurrentModes[Source].FrameBuffer.Ptr)
         {
+            // Queued presents still write to the frame buffer
+            m_HardwareBlt[Source].FlushPresents();
             UnmapFrameBuffer(m_CurrentModes[Source].FrameBuffer.Ptr, m_CurrentModes[Source].DispInfo.Height * m_CurrentModes[Source].DispInfo.Pitch);
             m_CurrentModes[Source].FrameBuffer.Ptr = NULL;
             m_CurrentModes[Source].Flags.FrameBufferIsActive = FALSE;
@@ -137,6 +137,13 @@ typedef struct _CURRENT_BDD_MODE
 } CURRENT_BDD_MODE;
 
 class BASIC_DISPLAY_DRIVER;
+struct DoPresentMemory;
+
+// Number of presents the present cost is averaged over before it is logged
+#define BDD_PRESENT_STATS_INTERVAL   256
+
+// Number of asynchronous presents a source can have queued or executing
+#define BDD_MAX_PENDING_PRESENTS     4
 
 class BDD_HWBLT
 {
@@ -147,9 +154,24 @@ public:
     HANDLE                          m_hPresentWorkerThread;
     PVOID                           m_pPresentWorkerThread;
 
+    // Asynchronous presents, executed in order by the present worker thread
+    FAST_MUTEX                      m_PresentQueueLock;
+    LIST_ENTRY                      m_PresentQueue;
+    UINT                            m_PresentsPending;      // Queued or executing
+    BOOLEAN                         m_StopPresentWorker;
+
     //  Events to contol thread execution
-    KEVENT                          m_hThreadStartupEvent;
-    KEVENT                          m_hThreadSuspendEvent;
+    KEVENT                          m_hPresentQueuedEvent;
+    KEVENT                          m_hPresentDoneEvent;
+
+    // Present cost and latency since they were last logged. Only the present worker
+    // thread and synchronous presents, which wait for the queue to drain, update them.
+    LONGLONG                        m_PresentTicks;
+    LONGLONG                        m_PresentBytes;
+    LONGLONG                        m_PresentLatencyTicks;
+    LONGLONG                        m_PresentMaxLatencyTicks;
+    UINT                            m_PresentCount;
+    UINT                            m_PresentsCollapsed;
 
     BDD_HWBLT();
 
@@ -157,6 +179,10 @@ public:
 
     void Initialize(_In_ BASIC_DISPLAY_DRIVER* DevExt, _In_ UINT IdSrc) { m_DevExt = DevExt; m_SourceId = IdSrc; }
     void SetPresentWorkerThreadInfo(HANDLE hWorkerThread);
+    void RecordPresentCost(_In_ LONGLONG Ticks, _In_ LONGLONG BytesWritten, _In_ LONGLONG LatencyTicks);
+    NTSTATUS QueuePresent(_In_ DoPresentMemory* pPresent);
+    void ProcessPresentQueue();
+    void FlushPresents();
     NTSTATUS ExecutePresentDisplayOnly(_In_ BYTE*             DstAddr,
                                        _In_ UINT              DstBitPerPixel,
                                        _In_ BYTE*             SrcAddr,
@@ -0,0 +1,131 @@
+/******************************Module*Header*******************************\
+ * Module Name: BltConvert.cxx
+ *
+ * Basic Display Driver row conversions from 32bpp to 24bpp and 16bpp
+ *
+ * The file is also built into the user mode benchmark in the Bench
+ * directory, so it must not depend on anything in BltFuncs.cxx.
+ *
+ * Copyright (c) 2010 Microsoft Corporation
+\**************************************************************************/
+
+#if defined(_KERNEL_MODE)
+#include "BDD.hxx"
+#else
+#include <windows.h>
+#endif
+#include "BltConvert.hxx"
+
+#if defined(_M_X64)
+#include <emmintrin.h>
+#endif // _M_X64
+
+#pragma code_seg(push)
+#pragma code_seg()
+// BEGIN: Non-Paged Code
+
+// Bit is 1 from Idx to end of byte, with bit count starting at high order
+BYTE lMaskTable[BITS_PER_BYTE] = {0xff, 0x7f, 0x3f, 0x1f, 0x0f, 0x07, 0x03, 0x01};
+
+// Bit is 1 from Idx to start of byte, with bit count starting at high order
+BYTE rMaskTable[BITS_PER_BYTE] = {0x80, 0xc0, 0xe0, 0xf0, 0xf8, 0xfc, 0xfe, 0xff};
+
+// Bit of Idx is 1, with bit count starting at high order
+BYTE PixelMask[BITS_PER_BYTE]  = {0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01};
+
+/****************************Internal*Routine******************************\
+ * ConvertRow32To24
+ *
+ *
+ * Drops the alpha byte of NumPixels 32bpp pixels. On x64 the pixels are
+ * converted 4 at a time with SSE2, which every x64 processor has and which
+ * kernel code may use there without saving the floating point state.
+ *
+\**************************************************************************/
+
+VOID ConvertRow32To24(
+    _Out_writes_bytes_(NumPixels * 3) BYTE* pDst,
+    _In_reads_bytes_(NumPixels * 4) CONST BYTE* pSrc,
+    UINT NumPixels)
+{
+    UINT i = 0;
+
+#if defined(_M_X64)
+    CONST __m128i Low24  = _mm_set1_epi64x(0x0000000000FFFFFF);
+    CONST __m128i High24 = _mm_set1_epi64x(0x0000FFFFFF000000);
+    CONST __m128i Zero   = _mm_setzero_si128();
+
+    // Each store writes 16 bytes of which 12 are pixels, so stop while the next pass
+    // still overwrites the other 4, rather than write past the end of the row
+    for (; i + 8 <= NumPixels; i += 4)
+    {
+        __m128i X = _mm_loadu_si128((CONST __m128i*)&pSrc[i * 4]);
+
+        // Close the gap between the two pixels of each qword, then between the qwords
+        X = _mm_or_si128(_mm_and_si128(X, Low24),
+                         _mm_and_si128(_mm_srli_epi64(X, 8), High24));
+        X = _mm_or_si128(_mm_move_epi64(X),
+                         _mm_srli_si128(_mm_unpackhi_epi64(Zero, X), 2));
+
+        _mm_storeu_si128((__m128i*)&pDst[i * 3], X);
+    }
+#endif // _M_X64
+
+    for (; i < NumPixels; i++)
+    {
+        pDst[i * 3 + 0] = pSrc[i * 4 + 0];
+        pDst[i * 3 + 1] = pSrc[i * 4 + 1];
+        pDst[i * 3 + 2] = pSrc[i * 4 + 2];
+    }
+}
+
+/****************************Internal*Routine******************************\
+ * ConvertRow32To16
+ *
+ *
+ * Converts NumPixels 32bpp pixels to 5:6:5, as CONVERT_32BPP_TO_16BPP does.
+ * On x64 the pixels are converted 8 at a time with SSE2.
+ *
+\**************************************************************************/
+
+VOID ConvertRow32To16(
+    _Out_writes_(NumPixels) UINT16* pDst,
+    _In_reads_(NumPixels) CONST UINT32* pSrc,
+    UINT NumPixels)
+{
+    UINT i = 0;
+
+#if defined(_M_X64)
+    CONST __m128i RedMask   = _mm_set1_epi32(0xF800);
+    CONST __m128i GreenMask = _mm_set1_epi32(0x07E0);
+    CONST __m128i BlueMask  = _mm_set1_epi32(0x001F);
+
+    for (; i + 8 <= NumPixels; i += 8)
+    {
+        __m128i Words[2];
+
+        for (UINT k = 0; k < 2; k++)
+        {
+            __m128i X = _mm_loadu_si128((CONST __m128i*)&pSrc[i + k * 4]);
+
+            X = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(X, 8), RedMask),
+                                          _mm_and_si128(_mm_srli_epi32(X, 5), GreenMask)),
+                             _mm_and_si128(_mm_srli_epi32(X, 3), BlueMask));
+
+            // Sign extend the low word so the saturating pack below keeps its bits as is
+            Words[k] = _mm_srai_epi32(_mm_slli_epi32(X, 16), 16);
+        }
+
+        _mm_storeu_si128((__m128i*)&pDst[i], _mm_packs_epi32(Words[0], Words[1]));
+    }
+#endif // _M_X64
+
+    for (; i < NumPixels; i++)
+    {
+        CONST BYTE* pPixel = (CONST BYTE*)&pSrc[i];
+        pDst[i] = (UINT16)CONVERT_32BPP_TO_16BPP(pPixel);
+    }
+}
+
+// END: Non-Paged Code
+#pragma code_seg(pop)
@@ -0,0 +1,73 @@
+/******************************Module*Header*******************************\
+* Module Name: BltConvert.hxx
+*
+* Basic Display Driver pixel format conversions
+*
+* BltConvert.cxx is also built into the user mode benchmark in the Bench
+* directory, so this header must not depend on anything in BDD.hxx.
+*
+* Copyright (c) 2010 Microsoft Corporation
+*
+\**************************************************************************/
+#ifndef _BLTCONVERT_HXX_
+#define _BLTCONVERT_HXX_
+
+#ifndef BITS_PER_BYTE
+#define BITS_PER_BYTE                  8
+#endif
+
+extern BYTE lMaskTable[BITS_PER_BYTE];
+extern BYTE rMaskTable[BITS_PER_BYTE];
+extern BYTE PixelMask[BITS_PER_BYTE];
+
+// For the following macros, c must be a UCHAR.
+#define UPPER_6_BITS(c)   (((c) & rMaskTable[6 - 1]) >> 2)
+#define UPPER_5_BITS(c)   (((c) & rMaskTable[5 - 1]) >> 3)
+#define LOWER_6_BITS(c)   (((BYTE)(c)) & lMaskTable[BITS_PER_BYTE - 6])
+#define LOWER_5_BITS(c)   (((BYTE)(c)) & lMaskTable[BITS_PER_BYTE - 5])
+
+
+#define SHIFT_FOR_UPPER_5_IN_565   (6 + 5)
+#define SHIFT_FOR_MIDDLE_6_IN_565  (5)
+#define SHIFT_UPPER_5_IN_565_BACK  ((BITS_PER_BYTE * 2) + (BITS_PER_BYTE - 5))
+#define SHIFT_MIDDLE_6_IN_565_BACK ((BITS_PER_BYTE * 1) + (BITS_PER_BYTE - 6))
+#define SHIFT_LOWER_5_IN_565_BACK  ((BITS_PER_BYTE * 0) + (BITS_PER_BYTE - 5))
+
+// For the following macros, pPixel must be a BYTE* pointing to the start of a 32 bit pixel
+#define CONVERT_32BPP_TO_16BPP(pPixel) ((UPPER_5_BITS(pPixel[2]) << SHIFT_FOR_UPPER_5_IN_565)  | \
+                                        (UPPER_6_BITS(pPixel[1]) << SHIFT_FOR_MIDDLE_6_IN_565) | \
+                                        (UPPER_5_BITS(pPixel[0])))
+
+// 8bpp is done with 6 levels per color channel since this gives true grays, even if it leaves 40 empty palette entries
+// The 6 levels per color is the reason for dividing below by 43 (43 * 6 == 258, closest multiple of 6 to 256)
+// It is also the reason for multiplying the red channel by 36 (== 6*6) and the green channel by 6, as this is the
+// equivalent to bit shifting in a 3:3:2 model. Changes to this must be reflected in vesasup.cxx with the Blues/Greens/Reds arrays
+#define CONVERT_32BPP_TO_8BPP(pPixel) (((pPixel[2] / 43) * 36) + \
+                                       ((pPixel[1] / 43) * 6) + \
+                                       ((pPixel[0] / 43)))
+
+// 4bpp is done with strict grayscale since this has been found to be usable
+// 30% of the red value, 59% of the green value, and 11% of the blue value is the standard way to convert true color to grayscale
+#define CONVERT_32BPP_TO_4BPP(pPixel) ((BYTE)(((pPixel[2] * 30) + \
+                                               (pPixel[1] * 59) + \
+                                               (pPixel[0] * 11)) / (100 * 16)))
+
+
+// For the following macro, Pixel must be a WORD representing a 16 bit pixel
+#define CONVERT_16BPP_TO_32BPP(Pixel) (((ULONG)LOWER_5_BITS((Pixel) >> SHIFT_FOR_UPPER_5_IN_565) << SHIFT_UPPER_5_IN_565_BACK) | \
+                                       ((ULONG)LOWER_6_BITS((Pixel) >> SHIFT_FOR_MIDDLE_6_IN_565) << SHIFT_MIDDLE_6_IN_565_BACK) | \
+                                       ((ULONG)LOWER_5_BITS((Pixel)) << SHIFT_LOWER_5_IN_565_BACK))
+
+// Must be Non-Paged
+VOID ConvertRow32To24(
+    _Out_writes_bytes_(NumPixels * 3) BYTE* pDst,
+    _In_reads_bytes_(NumPixels * 4) CONST BYTE* pSrc,
+    UINT NumPixels);
+
+// Must be Non-Paged
+VOID ConvertRow32To16(
+    _Out_writes_(NumPixels) UINT16* pDst,
+    _In_reads_(NumPixels) CONST UINT32* pSrc,
+    UINT NumPixels);
+
+#endif // _BLTCONVERT_HXX_
@@ -8,58 +8,12 @@
 \**************************************************************************/
 
 #include "BDD.hxx"
-
-// For the following macros, c must be a UCHAR.
-#define UPPER_6_BITS(c)   (((c) & rMaskTable[6 - 1]) >> 2)
-#define UPPER_5_BITS(c)   (((c) & rMaskTable[5 - 1]) >> 3)
-#define LOWER_6_BITS(c)   (((BYTE)(c)) & lMaskTable[BITS_PER_BYTE - 6])
-#define LOWER_5_BITS(c)   (((BYTE)(c)) & lMaskTable[BITS_PER_BYTE - 5])
-
-
-#define SHIFT_FOR_UPPER_5_IN_565   (6 + 5)
-#define SHIFT_FOR_MIDDLE_6_IN_565  (5)
-#define SHIFT_UPPER_5_IN_565_BACK  ((BITS_PER_BYTE * 2) + (BITS_PER_BYTE - 5))
-#define SHIFT_MIDDLE_6_IN_565_BACK ((BITS_PER_BYTE * 1) + (BITS_PER_BYTE - 6))
-#define SHIFT_LOWER_5_IN_565_BACK  ((BITS_PER_BYTE * 0) + (BITS_PER_BYTE - 5))
-
-// For the following macros, pPixel must be a BYTE* pointing to the start of a 32 bit pixel
-#define CONVERT_32BPP_TO_16BPP(pPixel) ((UPPER_5_BITS(pPixel[2]) << SHIFT_FOR_UPPER_5_IN_565)  | \
-                                        (UPPER_6_BITS(pPixel[1]) << SHIFT_FOR_MIDDLE_6_IN_565) | \
-                                        (UPPER_5_BITS(pPixel[0])))
-
-// 8bpp is done with 6 levels per color channel since this gives true grays, even if it leaves 40 empty palette entries
-// The 6 levels per color is the reason for dividing below by 43 (43 * 6 == 258, closest multiple of 6 to 256)
-// It is also the reason for multiplying the red channel by 36 (== 6*6) and the green channel by 6, as this is the
-// equivalent to bit shifting in a 3:3:2 model. Changes to this must be reflected in vesasup.cxx with the Blues/Greens/Reds arrays
-#define CONVERT_32BPP_TO_8BPP(pPixel) (((pPixel[2] / 43) * 36) + \
-                                       ((pPixel[1] / 43) * 6) + \
-                                       ((pPixel[0] / 43)))
-
-// 4bpp is done with strict grayscale since this has been found to be usable
-// 30% of the red value, 59% of the green value, and 11% of the blue value is the standard way to convert true color to grayscale
-#define CONVERT_32BPP_TO_4BPP(pPixel) ((BYTE)(((pPixel[2] * 30) + \
-                                               (pPixel[1] * 59) + \
-                                               (pPixel[0] * 11)) / (100 * 16)))
-
-
-// For the following macro, Pixel must be a WORD representing a 16 bit pixel
-#define CONVERT_16BPP_TO_32BPP(Pixel) (((ULONG)LOWER_5_BITS((Pixel) >> SHIFT_FOR_UPPER_5_IN_565) << SHIFT_UPPER_5_IN_565_BACK) | \
-                                       ((ULONG)LOWER_6_BITS((Pixel) >> SHIFT_FOR_MIDDLE_6_IN_565) << SHIFT_MIDDLE_6_IN_565_BACK) | \
-                                       ((ULONG)LOWER_5_BITS((Pixel)) << SHIFT_LOWER_5_IN_565_BACK))
+#include "BltConvert.hxx"
 
 #pragma code_seg(push)
 #pragma code_seg()
 // BEGIN: Non-Paged Code
 
-// Bit is 1 from Idx to end of byte, with bit count starting at high order
-BYTE lMaskTable[BITS_PER_BYTE] = {0xff, 0x7f, 0x3f, 0x1f, 0x0f, 0x07, 0x03, 0x01};
-
-// Bit is 1 from Idx to start of byte, with bit count starting at high order
-BYTE rMaskTable[BITS_PER_BYTE] = {0x80, 0xc0, 0xe0, 0xf0, 0xf8, 0xfc, 0xfe, 0xff};
-
-// Bit of Idx is 1, with bit count starting at high order
-BYTE PixelMask[BITS_PER_BYTE]  = {0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01};
-
 /****************************Internal*Routine******************************\
  * CopyBits32_32
  *
@@ -195,6 +149,55 @@ BYTE* GetRowStart(_In_ CONST BLT_INFO* pBltInfo, CONST RECT* pRect)
     return pRet;
 }
 
+/****************************Internal*Routine******************************\
+ * CopyBitsConvert32
+ *
+ *
+ * Copies rectangles from a 32bpp surface to a 24bpp or 16bpp surface of the
+ * same resolution, a row at a time. Neither surface may be rotated.
+ *
+\**************************************************************************/
+
+VOID CopyBitsConvert32(
+    BLT_INFO* pDst,
+    CONST BLT_INFO* pSrc,
+    UINT  NumRects,
+    _In_reads_(NumRects) CONST RECT *pRects)
+{
+    NT_ASSERT((pSrc->BitsPerPel == 32) &&
+              ((pDst->BitsPerPel == 24) || (pDst->BitsPerPel == 16)));
+    NT_ASSERT((pDst->Rotation == D3DKMDT_VPPR_IDENTITY) &&
+              (pSrc->Rotation == D3DKMDT_VPPR_IDENTITY));
+
+    for (UINT iRect = 0; iRect < NumRects; iRect++)
+    {
+        CONST RECT* pRect = &pRects[iRect];
+
+        NT_ASSERT(pRect->right >= pRect->left);
+        NT_ASSERT(pRect->bottom >= pRect->top);
+
+        UINT NumPixels = pRect->right - pRect->left;
+        UINT NumRows = pRect->bottom - pRect->top;
+
+        BYTE* pDstRow = GetRowStart(pDst, pRect);
+        CONST BYTE* pSrcRow = GetRowStart(pSrc, pRect);
+
+        for (UINT i = 0; i < NumRows; ++i)
+        {
+            if (pDst->BitsPerPel == 24)
+            {
+                ConvertRow32To24(pDstRow, pSrcRow, NumPixels);
+            }
+            else
+            {
+                ConvertRow32To16((UINT16*)pDstRow, (CONST UINT32*)pSrcRow, NumPixels);
+            }
+            pDstRow += pDst->Pitch;
+            pSrcRow += pSrc->Pitch;
+        }
+    }
+}
+
 /****************************Internal*Routine******************************\
  * CopyBitsGeneric
  *
@@ -205,8 +208,8 @@ BYTE* GetRowStart(_In_ CONST BLT_INFO* pBltInfo, CONST RECT* pRect)
  *    32 | 32   // For identity rotation this is much faster in CopyBits32_32
  *    32 | 24
  *    32 | 16
- *    24 | 32
- *    16 | 32
+ *    24 | 32   // For identity rotation this is much faster in CopyBitsConvert32
+ *    16 | 32   // For identity rotation this is much faster in CopyBitsConvert32
  *     8 | 32
  *    24 | 24   // untested
  *
@@ -329,6 +332,14 @@ VOID BltBits(
             // This is by far the most common copy function being called
             CopyBits32_32(pDst, pSrc, NumRects, pRects);
         }
+        else if (pSrc->BitsPerPel == 32 &&
+                 (pDst->BitsPerPel == 24 || pDst->BitsPerPel == 16) &&
+                 pDst->Rotation == D3DKMDT_VPPR_IDENTITY &&
+                 pSrc->Rotation == D3DKMDT_VPPR_IDENTITY)
+        {
+            // The usual case for a 24bpp or 16bpp frame buffer
+            CopyBitsConvert32(pDst, pSrc, NumRects, pRects);
+        }
         else
         {
             CopyBitsGeneric(pDst, pSrc, NumRects, pRects);
@@ -57,6 +57,7 @@ KSTART_ROUTINE HwContextWorkerThread;
 
 struct DoPresentMemory
 {
+    LIST_ENTRY                ListEntry;            // in:  Entry in the present queue of the source
     PVOID                     DstAddr;
     UINT                      DstStride;
     ULONG                     DstBitPerPixel;
@@ -64,6 +65,7 @@ struct DoPresentMemory
     UINT                      SrcHeight;
     BYTE*                     SrcAddr;
     LONG                      SrcPitch;
+    LONG                      SrcTop;               // in:  First source row mapped at SrcAddr
     ULONG                     NumMoves;             // in:  Number of screen to screen moves
     D3DKMT_MOVE_RECT*         Moves;               // in:  Point to the list of moves
     ULONG                     NumDirtyRects;        // in:  Number of direct rects
@@ -73,6 +75,9 @@ struct DoPresentMemory
     D3DDDI_VIDEO_PRESENT_SOURCE_ID  SourceID;
     HANDLE                    hAdapter;
     PMDL                      Mdl;
+    LONGLONG                  SubmitTicks;          // in:  When the OS submitted the present
+    LONGLONG                  MapTicks;             // in:  Time spent mapping the source
+    BOOLEAN                   FullFrame;            // in:  A dirty rect covers the whole source
     BDD_HWBLT*                DisplaySource;
 };
 
@@ -80,6 +85,12 @@ void
 HwExecutePresentDisplayOnly(
     HANDLE Context);
 
+void
+ReportPresentProgress(
+    _In_ HANDLE Adapter,
+    _In_ D3DDDI_VIDEO_PRESENT_SOURCE_ID VidPnSourceId,
+    _In_ BOOLEAN CompletedOrFailed);
+
 NTSTATUS
 StartHwBltPresentWorkerThread(
     _In_ PKSTART_ROUTINE StartRoutine,
@@ -88,15 +99,13 @@ StartHwBltPresentWorkerThread(
 
   Routine Description:
 
-    This routine creates the worker thread to execute a single present 
-    command. Creating a new thread on every asynchronous present is not 
-    efficient, but this file is only meant as a simulation, not an example 
-    of implementation.
+    This routine creates the worker thread that executes the asynchronous
+    presents of a source. The thread runs until the source is destroyed.
 
   Arguments:
 
     StartRoutine - start routine
-    StartContext - start context
+    StartContext - the BDD_HWBLT of the source
 
   Return Value:
 
@@ -110,9 +119,7 @@ StartHwBltPresentWorkerThread(
     InitializeObjectAttributes(&ObjectAttributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
     HANDLE hWorkerThread = NULL;
 
-    // copy data from the context which is need here, as it will be deleted in separate thread
-    DoPresentMemory* ctx = reinterpret_cast<DoPresentMemory*>(StartContext);
-    BDD_HWBLT* displaySource = ctx->DisplaySource;
+    BDD_HWBLT* displaySource = reinterpret_cast<BDD_HWBLT*>(StartContext);
 
     NTSTATUS Status = PsCreateSystemThread(
         &hWorkerThread,
@@ -128,29 +135,31 @@ StartHwBltPresentWorkerThread(
         return Status;
     }
 
-
-    // wait for thread to start - infinite wait -
-    // need to make sure the tread is running before OS stars submitting the work items to it
-    KeWaitForSingleObject(&displaySource->m_hThreadStartupEvent, Executive, KernelMode, FALSE, NULL);
-
     // Handle is passed to the parent object which must close it
     displaySource->SetPresentWorkerThreadInfo(hWorkerThread);
 
-    // Resume context thread, this is done by setting the event the thread is waiting on
-    KeSetEvent(&displaySource->m_hThreadSuspendEvent, 0, FALSE);
-
-    return STATUS_PENDING;
+    return STATUS_SUCCESS;
 }
 
 BDD_HWBLT::BDD_HWBLT():m_DevExt (NULL),
                 m_SynchExecution(TRUE),
                 m_hPresentWorkerThread(NULL),
-                m_pPresentWorkerThread(NULL)
+                m_pPresentWorkerThread(NULL),
+                m_PresentsPending(0),
+                m_StopPresentWorker(FALSE),
+                m_PresentTicks(0),
+                m_PresentBytes(0),
+                m_PresentLatencyTicks(0),
+                m_PresentMaxLatencyTicks(0),
+                m_PresentCount(0),
+                m_PresentsCollapsed(0)
 {
     PAGED_CODE();
 
-    KeInitializeEvent(&m_hThreadStartupEvent, NotificationEvent, FALSE);
-    KeInitializeEvent(&m_hThreadSuspendEvent, SynchronizationEvent, FALSE);
+    ExInitializeFastMutex(&m_PresentQueueLock);
+    InitializeListHead(&m_PresentQueue);
+    KeInitializeEvent(&m_hPresentQueuedEvent, SynchronizationEvent, FALSE);
+    KeInitializeEvent(&m_hPresentDoneEvent, NotificationEvent, FALSE);
 
 }
 
@@ -160,8 +169,9 @@ BDD_HWBLT::~BDD_HWBLT()
 
   Routine Description:
 
-    This routine waits on present worker thread to exit before
-    destroying the object
+    This routine stops the present worker thread, once it has executed
+    the queued presents, and waits on it to exit before destroying the
+    object
 
   Arguments:
 
@@ -175,6 +185,11 @@ BDD_HWBLT::~BDD_HWBLT()
 {
     PAGED_CODE();
 
+    ExAcquireFastMutex(&m_PresentQueueLock);
+    m_StopPresentWorker = TRUE;
+    ExReleaseFastMutex(&m_PresentQueueLock);
+    KeSetEvent(&m_hPresentQueuedEvent, 0, FALSE);
+
     // make sure the worker thread has exited
     SetPresentWorkerThreadInfo(NULL);
 }
@@ -191,7 +206,7 @@ BDD_HWBLT::SetPresentWorkerThreadInfo(
 
     The method is updating present worker information
     It is called in following cases:
-     - In ExecutePresent to update worker thread information
+     - In ExecutePresent to record the worker thread it started
      - In Dtor to wait on worker thread to exit
 
   Arguments:
@@ -233,6 +248,67 @@ BDD_HWBLT::SetPresentWorkerThreadInfo(
 }
 #pragma warning(pop)
 
+void
+BDD_HWBLT::RecordPresentCost(
+    _In_ LONGLONG Ticks,
+    _In_ LONGLONG BytesWritten,
+    _In_ LONGLONG LatencyTicks)
+/*++
+
+  Routine Description:
+
+    The method accumulates the cost and latency of a present and logs the
+    average cost per MB written to the frame buffer, and the mean and worst
+    submission to completion latency, every BDD_PRESENT_STATS_INTERVAL
+    presents
+
+  Arguments:
+
+    Ticks - performance counter ticks spent mapping the source and copying
+    BytesWritten - bytes written to the frame buffer
+    LatencyTicks - performance counter ticks from submission to completion
+
+  Return Value:
+
+    None
+
+--*/
+{
+    PAGED_CODE();
+
+    m_PresentTicks += Ticks;
+    m_PresentBytes += BytesWritten;
+    m_PresentLatencyTicks += LatencyTicks;
+    m_PresentMaxLatencyTicks = max(m_PresentMaxLatencyTicks, LatencyTicks);
+
+    if (++m_PresentCount < BDD_PRESENT_STATS_INTERVAL)
+    {
+        return;
+    }
+
+    LARGE_INTEGER Frequency;
+    KeQueryPerformanceCounter(&Frequency);
+
+    if (m_PresentBytes)
+    {
+        LONGLONG Microseconds = (m_PresentTicks * 1000000) / Frequency.QuadPart;
+        BDD_LOG_EVENT3("Present cost is 0x%I64x us per MB over 0x%I64x presents (0x%I64x bytes)",
+                       (Microseconds * 1024 * 1024) / m_PresentBytes, m_PresentCount, m_PresentBytes);
+    }
+
+    BDD_LOG_EVENT3("Present latency is 0x%I64x us mean, 0x%I64x us max, 0x%I64x presents collapsed",
+                   (m_PresentLatencyTicks * 1000000) / (Frequency.QuadPart * m_PresentCount),
+                   (m_PresentMaxLatencyTicks * 1000000) / Frequency.QuadPart,
+                   m_PresentsCollapsed);
+
+    m_PresentTicks = 0;
+    m_PresentBytes = 0;
+    m_PresentLatencyTicks = 0;
+    m_PresentMaxLatencyTicks = 0;
+    m_PresentCount = 0;
+    m_PresentsCollapsed = 0;
+}
+
 NTSTATUS
 BDD_HWBLT::ExecutePresentDisplayOnly(
     _In_ BYTE*             DstAddr,
@@ -291,6 +367,8 @@ BDD_HWBLT::ExecutePresentDisplayOnly(
 
     RtlZeroMemory(ctx,size);
 
+    ctx->SubmitTicks = KeQueryPerformanceCounter(NULL).QuadPart;
+
     const CURRENT_BDD_MODE* pModeCur = m_DevExt->GetCurrentMode(m_SourceId);
 
     ctx->DstAddr          = DstAddr;
@@ -316,13 +394,36 @@ BDD_HWBLT::ExecutePresentDisplayOnly(
 
     ctx->SynchExecution   = m_SynchExecution;
 
+    // Only the rows the moves and the dirty rects touch are read, so only those are mapped.
+    // The source has already been updated by the moves, so a move is copied from the source
+    // like a dirty rect; moving it within the frame buffer would read back write-combined
+    // memory, which is far slower than reading the source.
+    LONG SrcTop = LONG_MAX;
+    LONG SrcBottom = 0;
+
+    for (UINT i = 0; i < NumMoves; i++)
+    {
+        SrcTop = min(SrcTop, Moves[i].DestRect.top);
+        SrcBottom = max(SrcBottom, Moves[i].DestRect.bottom);
+    }
+
+    for (UINT i = 0; i < NumDirtyRects; i++)
+    {
+        SrcTop = min(SrcTop, DirtyRect[i].top);
+        SrcBottom = max(SrcBottom, DirtyRect[i].bottom);
+    }
+
+    if (SrcBottom > SrcTop)
     {
         // Map Source into kernel space, as Blt will be executed by system worker thread
-        UINT sizeToMap = SrcBytesPerPixel*pModeCur->SrcModeWidth*pModeCur->SrcModeHeight;
+        UINT SrcRowWidth = (Rotation == D3DKMDT_VPPR_ROTATE90 || Rotation == D3DKMDT_VPPR_ROTATE270) ?
+                               pModeCur->SrcModeHeight : pModeCur->SrcModeWidth;
+        UINT sizeToMap = (SrcBottom - SrcTop - 1)*SrcPitch + SrcBytesPerPixel*SrcRowWidth;
 
-        PMDL mdl = IoAllocateMdl((PVOID)SrcAddr, sizeToMap,  FALSE, FALSE, NULL);
+        PMDL mdl = IoAllocateMdl((PVOID)(SrcAddr + (SIZE_T)SrcTop*SrcPitch), sizeToMap,  FALSE, FALSE, NULL);
         if(!mdl)
         {
+            delete [] reinterpret_cast<BYTE*>(ctx);
             return STATUS_INSUFFICIENT_RESOURCES;
         }
 
@@ -339,6 +440,7 @@ BDD_HWBLT::ExecutePresentDisplayOnly(
         {
             Status = GetExceptionCode();
             IoFreeMdl(mdl);
+            delete [] reinterpret_cast<BYTE*>(ctx);
             return Status;
         }
 
@@ -352,13 +454,17 @@ BDD_HWBLT::ExecutePresentDisplayOnly(
             Status = STATUS_INSUFFICIENT_RESOURCES;
             MmUnlockPages(mdl);
             IoFreeMdl(mdl);
+            delete [] reinterpret_cast<BYTE*>(ctx);
             return Status;
         }
 
         // Save Mdl to unmap and unlock the pages in worker thread
         ctx->Mdl = mdl;
+        ctx->SrcTop = SrcTop;
     }
 
+    ctx->MapTicks = KeQueryPerformanceCounter(NULL).QuadPart - ctx->SubmitTicks;
+
     BYTE* rects = reinterpret_cast<BYTE*>(ctx+1);
 
     // copy moves and update pointer
@@ -376,17 +482,48 @@ BDD_HWBLT::ExecutePresentDisplayOnly(
         ctx->DirtyRect = reinterpret_cast<RECT*>(rects);
     }
 
+    // A present that rewrites the whole source supersedes the presents queued before it
+    UINT SrcWidth = ctx->SrcWidth;
+    UINT SrcHeight = ctx->SrcHeight;
+    if (Rotation == D3DKMDT_VPPR_ROTATE90 || Rotation == D3DKMDT_VPPR_ROTATE270)
+    {
+        SrcWidth = ctx->SrcHeight;
+        SrcHeight = ctx->SrcWidth;
+    }
+
+    for (UINT i = 0; i < NumDirtyRects; i++)
+    {
+        if (DirtyRect[i].left <= 0 && DirtyRect[i].top <= 0 &&
+            DirtyRect[i].right >= (LONG)SrcWidth && DirtyRect[i].bottom >= (LONG)SrcHeight)
+        {
+            ctx->FullFrame = TRUE;
+            break;
+        }
+    }
+
+    if (!m_SynchExecution && !m_pPresentWorkerThread)
+    {
+        // Start the worker thread that performs the presents asynchronously
+        Status = StartHwBltPresentWorkerThread(HwContextWorkerThread, (PVOID)this);
+        if (!NT_SUCCESS(Status))
+        {
+            BDD_LOG_WARNING1("Failed to start the present worker thread, Status = 0x%I64x, presenting synchronously", Status);
+            m_SynchExecution = TRUE;
+            ctx->SynchExecution = TRUE;
+        }
+    }
 
     if (m_SynchExecution)
     {
+        // Keep the presents in order
+        FlushPresents();
         HwExecutePresentDisplayOnly((PVOID)ctx);
         return STATUS_SUCCESS;
     }
     else
     {
-        // Create a worker thread to perform the present asynchronously
-        // Ctx will be deleted in worker thread (on exit)
-        return StartHwBltPresentWorkerThread(HwContextWorkerThread,(PVOID)ctx);
+        // Ctx will be deleted by the worker thread once it has been executed
+        return QueuePresent(ctx);
     }
 }
 
@@ -445,16 +582,196 @@ HwContextWorkerThread(
 {
     PAGED_CODE();
 
-    DoPresentMemory* ctx = reinterpret_cast<DoPresentMemory*>(Context);
-    BDD_HWBLT* displaySource = ctx->DisplaySource;
+    BDD_HWBLT* displaySource = reinterpret_cast<BDD_HWBLT*>(Context);
 
-    // Signal event to indicate that the tread has started
-    KeSetEvent(&displaySource->m_hThreadStartupEvent, 0, FALSE);
+    displaySource->ProcessPresentQueue();
+}
+
+
+void
+DiscardPresent(
+    _In_ DoPresentMemory* ctx)
+/*++
+
+  Routine Description:
+
+    The routine drops a queued present that a later present has superseded
+    and reports it as complete, as the later present will show its content
+
+  Arguments:
+
+    ctx - Context with present's command
 
-    // Suspend context thread, do this by waiting on the suspend event
-    KeWaitForSingleObject(&displaySource->m_hThreadSuspendEvent, Executive, KernelMode, FALSE, NULL);
+  Return Value:
 
-    HwExecutePresentDisplayOnly(Context);
+    None
+
+--*/
+{
+    PAGED_CODE();
+
+    if (ctx->Mdl)
+    {
+        MmUnlockPages(ctx->Mdl);
+        IoFreeMdl(ctx->Mdl);
+    }
+
+    // TRUE == completed
+    ReportPresentProgress(ctx->hAdapter,ctx->SourceID,TRUE);
+
+    delete [] reinterpret_cast<BYTE*>(ctx);
+}
+
+
+NTSTATUS
+BDD_HWBLT::QueuePresent(
+    _In_ DoPresentMemory* pPresent)
+/*++
+
+  Routine Description:
+
+    The method queues an asynchronous present for the worker thread. A
+    present that rewrites the whole source collapses the presents queued
+    before it that have not started executing. If the queue is full, the
+    method waits for the oldest present to complete.
+
+  Arguments:
+
+    pPresent - Context with present's command
+
+  Return Value:
+
+    STATUS_PENDING
+
+--*/
+{
+    PAGED_CODE();
+
+    LIST_ENTRY Collapsed;
+    InitializeListHead(&Collapsed);
+
+    ExAcquireFastMutex(&m_PresentQueueLock);
+
+    if (pPresent->FullFrame)
+    {
+        while (!IsListEmpty(&m_PresentQueue))
+        {
+            InsertTailList(&Collapsed, RemoveHeadList(&m_PresentQueue));
+            m_PresentsPending--;
+            m_PresentsCollapsed++;
+        }
+    }
+
+    while (m_PresentsPending >= BDD_MAX_PENDING_PRESENTS)
+    {
+        // The worker thread sets the event under the lock, so clearing it here can't lose a completion
+        KeClearEvent(&m_hPresentDoneEvent);
+        ExReleaseFastMutex(&m_PresentQueueLock);
+        KeWaitForSingleObject(&m_hPresentDoneEvent, Executive, KernelMode, FALSE, NULL);
+        ExAcquireFastMutex(&m_PresentQueueLock);
+    }
+
+    InsertTailList(&m_PresentQueue, &pPresent->ListEntry);
+    m_PresentsPending++;
+
+    ExReleaseFastMutex(&m_PresentQueueLock);
+
+    KeSetEvent(&m_hPresentQueuedEvent, 0, FALSE);
+
+    // Report the superseded presents outside the lock, in submission order
+    while (!IsListEmpty(&Collapsed))
+    {
+        DiscardPresent(CONTAINING_RECORD(RemoveHeadList(&Collapsed), DoPresentMemory, ListEntry));
+    }
+
+    return STATUS_PENDING;
+}
+
+
+void
+BDD_HWBLT::ProcessPresentQueue()
+/*++
+
+  Routine Description:
+
+    The method is the body of the present worker thread. It executes the
+    queued presents in order until the object is destroyed.
+
+  Arguments:
+
+    None
+
+  Return Value:
+
+    None
+
+--*/
+{
+    PAGED_CODE();
+
+    for (;;)
+    {
+        ExAcquireFastMutex(&m_PresentQueueLock);
+
+        if (IsListEmpty(&m_PresentQueue))
+        {
+            BOOLEAN Stop = m_StopPresentWorker;
+            ExReleaseFastMutex(&m_PresentQueueLock);
+
+            if (Stop)
+            {
+                return;
+            }
+
+            KeWaitForSingleObject(&m_hPresentQueuedEvent, Executive, KernelMode, FALSE, NULL);
+            continue;
+        }
+
+        DoPresentMemory* ctx = CONTAINING_RECORD(RemoveHeadList(&m_PresentQueue), DoPresentMemory, ListEntry);
+        ExReleaseFastMutex(&m_PresentQueueLock);
+
+        // Ctx is deleted once executed
+        HwExecutePresentDisplayOnly((PVOID)ctx);
+
+        ExAcquireFastMutex(&m_PresentQueueLock);
+        m_PresentsPending--;
+        KeSetEvent(&m_hPresentDoneEvent, 0, FALSE);
+        ExReleaseFastMutex(&m_PresentQueueLock);
+    }
+}
+
+
+void
+BDD_HWBLT::FlushPresents()
+/*++
+
+  Routine Description:
+
+    The method waits for the queued and executing presents to complete
+
+  Arguments:
+
+    None
+
+  Return Value:
+
+    None
+
+--*/
+{
+    PAGED_CODE();
+
+    ExAcquireFastMutex(&m_PresentQueueLock);
+
+    while (m_PresentsPending)
+    {
+        KeClearEvent(&m_hPresentDoneEvent);
+        ExReleaseFastMutex(&m_PresentQueueLock);
+        KeWaitForSingleObject(&m_hPresentDoneEvent, Executive, KernelMode, FALSE, NULL);
+        ExAcquireFastMutex(&m_PresentQueueLock);
+    }
+
+    ExReleaseFastMutex(&m_PresentQueueLock);
 }
 
 
@@ -480,6 +797,7 @@ HwExecutePresentDisplayOnly(
     PAGED_CODE();
 
     DoPresentMemory* ctx = reinterpret_cast<DoPresentMemory*>(Context);
+    LONGLONG BltStart = KeQueryPerformanceCounter(NULL).QuadPart;
 
     // Set up destination blt info
     BLT_INFO DstBltInfo;
@@ -498,7 +816,7 @@ HwExecutePresentDisplayOnly(
     SrcBltInfo.Pitch = ctx->SrcPitch;
     SrcBltInfo.BitsPerPel = 32;
     SrcBltInfo.Offset.x = 0;
-    SrcBltInfo.Offset.y = 0;
+    SrcBltInfo.Offset.y = -ctx->SrcTop;
     SrcBltInfo.Rotation = D3DKMDT_VPPR_IDENTITY;
     if (ctx->Rotation == D3DKMDT_VPPR_ROTATE90 ||
         ctx->Rotation == D3DKMDT_VPPR_ROTATE270)
@@ -513,23 +831,34 @@ HwExecutePresentDisplayOnly(
     }
 
 
+    LONGLONG PixelsWritten = 0;
+
     // Copy all the scroll rects from source image to video frame buffer.
     for (UINT i = 0; i < ctx->NumMoves; i++)
     {
+        CONST RECT* pRect = &ctx->Moves[i].DestRect;
+
         BltBits(&DstBltInfo,
         &SrcBltInfo,
         1, // NumRects
-        &ctx->Moves[i].DestRect);
+        pRect);
+
+        PixelsWritten += (LONGLONG)(pRect->right - pRect->left) * (pRect->bottom - pRect->top);
     }
 
     // Copy all the dirty rects from source image to video frame buffer.
-    for (UINT i = 0; i < ctx->NumDirtyRects; i++)
+    if (ctx->NumDirtyRects)
     {
-
         BltBits(&DstBltInfo,
         &SrcBltInfo,
-        1, // NumRects
-        &ctx->DirtyRect[i]);
+        ctx->NumDirtyRects,
+        ctx->DirtyRect);
+
+        for (UINT i = 0; i < ctx->NumDirtyRects; i++)
+        {
+            CONST RECT* pRect = &ctx->DirtyRect[i];
+            PixelsWritten += (LONGLONG)(pRect->right - pRect->left) * (pRect->bottom - pRect->top);
+        }
     }
 
     // Unmap unmap and unlock the pages.
@@ -539,6 +868,11 @@ HwExecutePresentDisplayOnly(
         IoFreeMdl(ctx->Mdl);
     }
 
+    LONGLONG BltEnd = KeQueryPerformanceCounter(NULL).QuadPart;
+    ctx->DisplaySource->RecordPresentCost(ctx->MapTicks + BltEnd - BltStart,
+                                          PixelsWritten * ctx->DstBitPerPixel / BITS_PER_BYTE,
+                                          BltEnd - ctx->SubmitTicks);
+
     if(ctx->SynchExecution)
     {
         // This code simulates Blt executed synchronously
@@ -629,38 +629,24 @@ Return Value:
     NTSTATUS status;
     WDFDEVICE device;
     PWMI_SAMPLE_DEVICE_DATA wmiDeviceData;
-    ULONG sizeNeeded;
-    ULONG sizeUsed;
-    ULONG i;
 
-    UNREFERENCED_PARAMETER(OutBufferSize);
     PAGED_CODE();
 
     device = WdfWmiInstanceGetDevice(WmiInstance);
     wmiDeviceData = GetWmiSampleDeviceData(device);
 
     //
-    // Fixed array of EC1.
+    // Fixed array of EC1. The snapshot is already in data block layout, so
+    // the whole array is copied at once.
     //
-    sizeNeeded = 0;
-    for (i = 0; i < EC1_COUNT; i++) {
-        sizeNeeded += ALIGN_UP(wmiDeviceData->Ec1Length[i], PVOID);
-    }
-
-    if (OutBufferSize < sizeNeeded) {
+    if (OutBufferSize < EC1_COUNT * EC1_STRIDE) {
 
         *BufferUsed = 0;
         status = STATUS_BUFFER_TOO_SMALL;
 
     } else {
 
-        *BufferUsed = 0;
-        for (i = 0; i < EC1_COUNT; i++) {
-
-            sizeUsed = WmiSampGetEc1(wmiDeviceData, OutBuffer, i);
-            OutBuffer = Add2Ptr(OutBuffer, ALIGN_UP(sizeUsed, PVOID));
-            *BufferUsed += sizeUsed;
-        }
+        *BufferUsed = WmiSampGetAllEc1(wmiDeviceData, OutBuffer);
         status = STATUS_SUCCESS;
     }
 
@@ -855,38 +841,24 @@ Return Value:
     NTSTATUS status;
     WDFDEVICE device;
     PWMI_SAMPLE_DEVICE_DATA wmiDeviceData;
-    ULONG sizeNeeded;
-    ULONG sizeUsed;
-    ULONG i;
 
-    UNREFERENCED_PARAMETER(OutBufferSize);
     PAGED_CODE();
 
     device = WdfWmiInstanceGetDevice(WmiInstance);
     wmiDeviceData = GetWmiSampleDeviceData(device);
 
     //
-    // Fixed array of EC2.
+    // Fixed array of EC2. The snapshot is already in data block layout, so
+    // the whole array is copied at once.
     //
-    sizeNeeded = 0;
-    for (i = 0; i < EC2_COUNT; i++) {
-        sizeNeeded += ALIGN_UP(wmiDeviceData->Ec2Length[i], PVOID);
-    }
-
-    if (OutBufferSize < sizeNeeded) {
+    if (OutBufferSize < EC2_COUNT * EC2_STRIDE) {
 
         *BufferUsed = 0;
         status = STATUS_BUFFER_TOO_SMALL;
 
     } else {
 
-        *BufferUsed = 0;
-        for (i = 0; i < EC2_COUNT; i++) {
-
-            sizeUsed = WmiSampGetEc2(wmiDeviceData, OutBuffer, i);
-            OutBuffer = Add2Ptr(OutBuffer, ALIGN_UP(sizeUsed, PVOID));
-            *BufferUsed += sizeUsed;
-        }
+        *BufferUsed = WmiSampGetAllEc2(wmiDeviceData, OutBuffer);
         status = STATUS_SUCCESS;
     }
 
@@ -30,12 +30,6 @@ Environment:
 #endif
 
 
-//
-// Define a tag for use by the memory allocation routines.
-//
-#define WMI_SAMPLE_TAG (ULONG)'SimW'
-
-
 //
 // Private methods.
 //
@@ -51,6 +45,24 @@ PriStartNewPeriodicTimer(
 EVT_WDF_TIMER PriTimerCallback;
 
 
+VOID
+PriReadSnapshot(
+    _In_ volatile LONG *Sequence,
+    _In_reads_bytes_(Length) PVOID Snapshot,
+    _In_ ULONG Length,
+    _Out_writes_bytes_(Length) PVOID Buffer
+    );
+
+VOID
+PriWriteSnapshot(
+    _Inout_ volatile LONG *Sequence,
+    _Out_writes_bytes_(Stride) PVOID Snapshot,
+    _In_ ULONG Stride,
+    _In_reads_bytes_(Length) PVOID Buffer,
+    _In_ ULONG Length
+    );
+
+
 NTSTATUS
 DriverEntry(
     _In_ PDRIVER_OBJECT DriverObject,
@@ -115,12 +127,6 @@ WmiSampEvtDeviceAdd(
     //
     WDF_OBJECT_ATTRIBUTES_SET_CONTEXT_TYPE(&wdfObjAttributes, WMI_SAMPLE_DEVICE_DATA);
 
-    //
-    // Specify the callback function for cleaning up the WDF device object specific
-    // memory allocations.
-    //
-    wdfObjAttributes.EvtDestroyCallback = WmiSampDeviceEvtDestroyCallback;
-
     //
     // Create a Framework Device object.
     //
@@ -140,8 +146,8 @@ WmiSampEvtDeviceAdd(
     wmiDeviceData->Ec2Count = EC2_COUNT;
 
     //
-    // Create a wdf spin lock object to protect access to the EC1 data and parent
-    // the object to the device object.
+    // Create a wdf spin lock object to serialize updates of the EC1 data and
+    // parent the object to the device object.
     //
     WDF_OBJECT_ATTRIBUTES_INIT(&wdfObjAttributes);
     wdfObjAttributes.ParentObject = deviceObject;
@@ -154,8 +160,8 @@ WmiSampEvtDeviceAdd(
     }
 
     //
-    // Create a wdf spin lock object to protect access to the EC2 data and parent
-    // the object to the device object.
+    // Create a wdf spin lock object to serialize updates of the EC2 data and
+    // parent the object to the device object.
     //
     status = WdfSpinLockCreate(&wdfObjAttributes, &wmiDeviceData->Ec2Lock);
     if (!NT_SUCCESS(status)) {
@@ -204,61 +210,71 @@ WmiSampEvtDeviceAdd(
 }
 
 
-VOID
-WmiSampDeviceEvtDestroyCallback(
-    WDFOBJECT DeviceObject
+_Success_(return > 0)
+ULONG
+WmiSampGetEc1(
+    _In_    PWMI_SAMPLE_DEVICE_DATA WmiDeviceData,
+    _Out_ PVOID Buffer,
+    _In_    ULONG Index
     )
+{
+    if (Index >= EC1_COUNT) {
+        return 0;
+    }
 
-/*++
-
-Routine Description:
-
-    This callback function is called by the framework when the reference count
-    on the WDF device object is zero and the framework is ready to release the
-    resouces held by this object. All object specific resource allocations that
-    were NOT made by the framework must be released here to avoid a resource
-    leak.
+    PriReadSnapshot(&WmiDeviceData->Ec1Sequence,
+                    Add2Ptr(WmiDeviceData->Ec1Snapshot, Index * EC1_STRIDE),
+                    EC1_STRIDE,
+                    Buffer);
 
-Arguments:
+    return EC1_STRIDE;
+}
 
-    DeviceObject - The WDF device object that is about to be destroyed by the
-        framework.
 
-Return Value:
+ULONG
+WmiSampGetAllEc1(
+    _In_ PWMI_SAMPLE_DEVICE_DATA WmiDeviceData,
+    _Out_writes_bytes_(EC1_COUNT * EC1_STRIDE) PVOID Buffer
+    )
+{
+    PriReadSnapshot(&WmiDeviceData->Ec1Sequence,
+                    WmiDeviceData->Ec1Snapshot,
+                    sizeof(WmiDeviceData->Ec1Snapshot),
+                    Buffer);
 
-    VOID.
+    return sizeof(WmiDeviceData->Ec1Snapshot);
+}
 
---*/
 
+VOID
+WmiSampSetEc1(
+    _In_ PWMI_SAMPLE_DEVICE_DATA WmiDeviceData,
+    _In_ PVOID Buffer,
+    _In_ ULONG Length,
+    _In_ ULONG Index
+    )
 {
-    ULONG index;
-    PWMI_SAMPLE_DEVICE_DATA wmiDeviceData;
-
-    wmiDeviceData = GetWmiSampleDeviceData((WDFDEVICE)DeviceObject);
+    if ((Index >= EC1_COUNT) || (Length > EC1_SIZE)) {
+        return;
+    }
 
     //
-    // Release the memory allocated for EC1. The wdfspinlock Ec1Lock memory
-    // will be released automatically by the framework as part of the device
-    // object cleanup.
+    // Acquire the lock to serialize updates of the EC1 data since multiple
+    // threads could be trying to change it concurrently. Queries do not take
+    // the lock; they rely on the sequence instead.
     //
-    for (index = 0; index < EC1_COUNT; index++) {
-        if (wmiDeviceData->Ec1[index] != NULL) {
-            ExFreePool(wmiDeviceData->Ec1[index]);
-            wmiDeviceData->Ec1[index] = NULL;
-        }
-    }
+    WdfSpinLockAcquire(WmiDeviceData->Ec1Lock);
+
+    PriWriteSnapshot(&WmiDeviceData->Ec1Sequence,
+                     Add2Ptr(WmiDeviceData->Ec1Snapshot, Index * EC1_STRIDE),
+                     EC1_STRIDE,
+                     Buffer,
+                     Length);
 
     //
-    // Release the memory allocated for EC2. The wdfspinlock Ec2Lock memory
-    // will be released automatically by the framework as part of the device
-    // object cleanup.
+    // Release the lock.
     //
-    for (index = 0; index < EC2_COUNT; index++) {
-        if (wmiDeviceData->Ec2[index] != NULL) {
-            ExFreePool(wmiDeviceData->Ec2[index]);
-            wmiDeviceData->Ec2[index] = NULL;
-        }
-    }
+    WdfSpinLockRelease(WmiDeviceData->Ec1Lock);
 
     return;
 }
@@ -266,77 +282,129 @@ Return Value:
 
 _Success_(return > 0)
 ULONG
-WmiSampGetEc1(
+WmiSampGetEc2(
     _In_    PWMI_SAMPLE_DEVICE_DATA WmiDeviceData,
     _Out_ PVOID Buffer,
     _In_    ULONG Index
     )
 {
-    ULONG ec1Length = 0;
-    if (Index >= EC1_COUNT) {
-        return ec1Length;
+    if (Index >= EC2_COUNT) {
+        return 0;
     }
 
-    //
-    // Acquire the lock to protect access to the EC1 data since multiple
-    // threads could be trying to access the common data concurrently.
-    //
-    WdfSpinLockAcquire(WmiDeviceData->Ec1Lock);
+    PriReadSnapshot(&WmiDeviceData->Ec2Sequence,
+                    Add2Ptr(WmiDeviceData->Ec2Snapshot, Index * EC2_STRIDE),
+                    EC2_STRIDE,
+                    Buffer);
 
-    RtlCopyMemory(Buffer,
-                  WmiDeviceData->Ec1[Index],
-                  WmiDeviceData->Ec1Length[Index]);
+    return EC2_STRIDE;
+}
 
-    ec1Length = WmiDeviceData->Ec1Length[Index];
 
-    //
-    // Release the lock.
-    //
-    WdfSpinLockRelease(WmiDeviceData->Ec1Lock);
+ULONG
+WmiSampGetAllEc2(
+    _In_ PWMI_SAMPLE_DEVICE_DATA WmiDeviceData,
+    _Out_writes_bytes_(EC2_COUNT * EC2_STRIDE) PVOID Buffer
+    )
+{
+    PriReadSnapshot(&WmiDeviceData->Ec2Sequence,
+                    WmiDeviceData->Ec2Snapshot,
+                    sizeof(WmiDeviceData->Ec2Snapshot),
+                    Buffer);
 
-    return ec1Length;
+    return sizeof(WmiDeviceData->Ec2Snapshot);
 }
 
 
 VOID
-WmiSampSetEc1(
+WmiSampSetEc2(
     _In_ PWMI_SAMPLE_DEVICE_DATA WmiDeviceData,
     _In_ PVOID Buffer,
     _In_ ULONG Length,
     _In_ ULONG Index
     )
 {
-    PEC1 ec1;
-    ULONG ec1Length = ALIGN_UP(Length, PVOID);
-    PVOID oldBuffer = NULL;
-
-    if (Index >= EC1_COUNT) {
+    if ((Index >= EC2_COUNT) || (Length > EC2_SIZE)) {
         return;
     }
 
-    ec1 = ExAllocatePoolWithTag(NonPagedPool, ec1Length, WMI_SAMPLE_TAG);
-    if (ec1 != NULL) {
+    //
+    // Acquire the lock to serialize updates of the EC2 data since multiple
+    // threads could be trying to change it concurrently. Queries do not take
+    // the lock; they rely on the sequence instead.
+    //
+    WdfSpinLockAcquire(WmiDeviceData->Ec2Lock);
 
-        RtlCopyMemory(ec1, Buffer, Length);
+    PriWriteSnapshot(&WmiDeviceData->Ec2Sequence,
+                     Add2Ptr(WmiDeviceData->Ec2Snapshot, Index * EC2_STRIDE),
+                     EC2_STRIDE,
+                     Buffer,
+                     Length);
 
-        //
-        // Acquire the lock to protect access to the EC1 data since multiple
-        // threads could be trying to access the common data concurrently.
-        //
-        WdfSpinLockAcquire(WmiDeviceData->Ec1Lock);
+    //
+    // Release the lock.
+    //
+    WdfSpinLockRelease(WmiDeviceData->Ec2Lock);
+
+    return;
+}
+
+
+VOID
+PriReadSnapshot(
+    _In_ volatile LONG *Sequence,
+    _In_reads_bytes_(Length) PVOID Snapshot,
+    _In_ ULONG Length,
+    _Out_writes_bytes_(Length) PVOID Buffer
+    )
+
+/*++
+
+Routine Description:
+
+    This function copies a consistent view of a snapshot without taking the
+    lock that serializes its updates. The copy is retried until it did not
+    overlap an update.
+
+Arguments:
+
+    Sequence - The sequence that guards the snapshot.
+
+    Snapshot - The part of the snapshot to copy.
 
-        oldBuffer = WmiDeviceData->Ec1[Index];
-        WmiDeviceData->Ec1[Index] = ec1;
-        WmiDeviceData->Ec1Length[Index] = ec1Length;
-        WmiDeviceData->Ec1ActualLength[Index] = Length;
+    Length - The number of bytes to copy.
+
+    Buffer - The buffer that receives the copy.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    LONG sequence;
+
+    for (;;) {
+
+        sequence = ReadAcquire(Sequence);
+        if ((sequence & 1) != 0) {
+
+            //
+            // An update is in progress.
+            //
+            YieldProcessor();
+            continue;
+        }
+
+        RtlCopyMemory(Buffer, Snapshot, Length);
 
         //
-        // Release the lock.
+        // Order the copy before the second read of the sequence.
         //
-        WdfSpinLockRelease(WmiDeviceData->Ec1Lock);
-
-        if (oldBuffer != NULL) {
-            ExFreePool(oldBuffer);
+        KeMemoryBarrier();
+        if (ReadNoFence(Sequence) == sequence) {
+            break;
         }
     }
 
@@ -344,81 +412,52 @@ WmiSampSetEc1(
 }
 
 
-_Success_(return > 0)
-ULONG
-WmiSampGetEc2(
-    _In_    PWMI_SAMPLE_DEVICE_DATA WmiDeviceData,
-    _Out_ PVOID Buffer,
-    _In_    ULONG Index
+VOID
+PriWriteSnapshot(
+    _Inout_ volatile LONG *Sequence,
+    _Out_writes_bytes_(Stride) PVOID Snapshot,
+    _In_ ULONG Stride,
+    _In_reads_bytes_(Length) PVOID Buffer,
+    _In_ ULONG Length
     )
-{
-    ULONG ec2Length = 0;
-    if (Index >= EC2_COUNT) {
-        return ec2Length;
-    }
 
-    //
-    // Acquire the lock to protect access to the EC2 data since multiple
-    // threads could be trying to access the common data concurrently.
-    //
-    WdfSpinLockAcquire(WmiDeviceData->Ec2Lock);
+/*++
 
-    RtlCopyMemory(Buffer,
-                  WmiDeviceData->Ec2[Index],
-                  WmiDeviceData->Ec2Length[Index]);
+Routine Description:
 
-    ec2Length = WmiDeviceData->Ec2Length[Index];
+    This function updates one entry of a snapshot. The caller must hold the
+    lock that serializes updates of the snapshot.
 
-    //
-    // Release the lock.
-    //
-    WdfSpinLockRelease(WmiDeviceData->Ec2Lock);
+Arguments:
 
-    return ec2Length;
-}
+    Sequence - The sequence that guards the snapshot.
 
+    Snapshot - The entry to update.
 
-VOID
-WmiSampSetEc2(
-    _In_ PWMI_SAMPLE_DEVICE_DATA WmiDeviceData,
-    _In_ PVOID Buffer,
-    _In_ ULONG Length,
-    _In_ ULONG Index
-    )
-{
-    PEC2 ec2;
-    ULONG ec2Length = ALIGN_UP(Length, PVOID);
-    PVOID oldBuffer = NULL;
+    Stride - The size of the entry, including the alignment padding.
 
-    if (Index >= EC2_COUNT) {
-        return;
-    }
+    Buffer - The new contents of the entry.
 
-    ec2 = ExAllocatePoolWithTag(NonPagedPool, ec2Length, WMI_SAMPLE_TAG);
-    if (ec2 != NULL) {
+    Length - The number of bytes in Buffer. The rest of the entry is zeroed.
 
-        RtlCopyMemory(ec2, Buffer, Length);
+Return Value:
 
-        //
-        // Acquire the lock to protect access to the EC2 data since multiple
-        // threads could be trying to access the common data concurrently.
-        //
-        WdfSpinLockAcquire(WmiDeviceData->Ec2Lock);
+    None.
 
-        oldBuffer = WmiDeviceData->Ec2[Index];
-        WmiDeviceData->Ec2[Index] = ec2;
-        WmiDeviceData->Ec2Length[Index] = ec2Length;
-        WmiDeviceData->Ec2ActualLength[Index] = Length;
+--*/
 
-        //
-        // Release the lock.
-        //
-        WdfSpinLockRelease(WmiDeviceData->Ec2Lock);
+{
+    //
+    // The interlocked increments are full barriers, so queries cannot see the
+    // new contents before the sequence turns odd or the even sequence before
+    // the new contents.
+    //
+    InterlockedIncrement(Sequence);
 
-        if (oldBuffer != NULL) {
-            ExFreePool(oldBuffer);
-        }
-    }
+    RtlCopyMemory(Snapshot, Buffer, Length);
+    RtlZeroMemory(Add2Ptr(Snapshot, Length), Stride - Length);
+
+    InterlockedIncrement(Sequence);
 
     return;
 }
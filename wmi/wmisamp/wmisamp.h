@@ -61,21 +61,33 @@ typedef struct _WMI_SAMPLE_INSTANCE_CONFIG {
 #define EC1_COUNT       4
 #define EC2_COUNT       4
 
+//
+// Each embedded class instance is stored padded to pointer alignment, which
+// is how a fixed array of the embedded class is laid out in a WMI data block.
+//
+#define EC1_STRIDE      ALIGN_UP(EC1_SIZE, PVOID)
+#define EC2_STRIDE      ALIGN_UP(EC2_SIZE, PVOID)
+
 //
 // Data storage for WMI data blocks.
 //
+// The EC1 and EC2 instances are kept as snapshots already in data block
+// layout, so a query of one instance or of the whole array is served with a
+// single copy. Updates are serialized by the EC lock and bracket the write
+// with increments of the sequence, which is odd while an update is in
+// progress. Queries copy without taking the lock and retry if the sequence
+// was odd or changed during the copy.
+//
 typedef struct _WMI_SAMPLE_DEVICE_DATA {
 
     ULONG Ec1Count;
-    ULONG Ec1Length[EC1_COUNT];
-    ULONG Ec1ActualLength[EC1_COUNT];
-    PEC1 Ec1[EC1_COUNT];
+    volatile LONG Ec1Sequence;
+    UCHAR Ec1Snapshot[EC1_COUNT * EC1_STRIDE];
     WDFSPINLOCK Ec1Lock;
 
     ULONG Ec2Count;
-    ULONG Ec2Length[EC2_COUNT];
-    ULONG Ec2ActualLength[EC2_COUNT];
-    PEC2 Ec2[EC2_COUNT];
+    volatile LONG Ec2Sequence;
+    UCHAR Ec2Snapshot[EC2_COUNT * EC2_STRIDE];
     WDFSPINLOCK Ec2Lock;
 
     WDFWMIINSTANCE DynamicInstance;
@@ -93,7 +105,6 @@ WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(WMI_SAMPLE_DEVICE_DATA, GetWmiSampleDeviceDat
 DRIVER_INITIALIZE DriverEntry;
 
 EVT_WDF_DRIVER_DEVICE_ADD WmiSampEvtDeviceAdd;
-EVT_WDF_DEVICE_CONTEXT_DESTROY WmiSampDeviceEvtDestroyCallback;
 
 NTSTATUS
 WmiSampWmiRegistration(
@@ -113,6 +124,12 @@ WmiSampGetEc1(
     _In_    ULONG Index
     );
 
+ULONG
+WmiSampGetAllEc1(
+    _In_ PWMI_SAMPLE_DEVICE_DATA WmiDeviceData,
+    _Out_writes_bytes_(EC1_COUNT * EC1_STRIDE) PVOID Buffer
+    );
+
 VOID
 WmiSampSetEc1(
     _In_ PWMI_SAMPLE_DEVICE_DATA WmiDeviceData,
@@ -129,6 +146,12 @@ WmiSampGetEc2(
     _In_    ULONG Index
     );
 
+ULONG
+WmiSampGetAllEc2(
+    _In_ PWMI_SAMPLE_DEVICE_DATA WmiDeviceData,
+    _Out_writes_bytes_(EC2_COUNT * EC2_STRIDE) PVOID Buffer
+    );
+
 VOID
 WmiSampSetEc2(
     _In_ PWMI_SAMPLE_DEVICE_DATA WmiDeviceData,
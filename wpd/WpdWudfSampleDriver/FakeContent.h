@@ -459,6 +459,9 @@ public:
     BOOL            IsSystem;
     BOOL            NonConsumable;
     CAtlArray<GUID> RestrictToContentTypes;
+
+    // Property blob cached by FakeDevice::GetCachedValues; not copied with the object
+    CComPtr<IPortableDeviceValues> CachedValues;
 };
 
 class FakeGenericFileContent : public FakeContent
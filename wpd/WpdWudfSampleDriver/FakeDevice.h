@@ -67,7 +67,7 @@ public:
 
             _ATLTRY
             {
-                m_Content.Add(pDeviceObjectContent);
+                AddContent(pDeviceObjectContent);
             }
             _ATLCATCH(e)
             {
@@ -99,7 +99,7 @@ public:
 
             _ATLTRY
             {
-                m_Content.Add(pStorageContent);
+                AddContent(pStorageContent);
             }
             _ATLCATCH(e)
             {
@@ -131,7 +131,7 @@ public:
 
             _ATLTRY
             {
-                m_Content.Add(pStorageContent);
+                AddContent(pStorageContent);
             }
             _ATLCATCH(e)
             {
@@ -161,7 +161,7 @@ public:
 
             _ATLTRY
             {
-                m_Content.Add(pRenderingInformationContent);
+                AddContent(pRenderingInformationContent);
             }
             _ATLCATCH(e)
             {
@@ -193,7 +193,7 @@ public:
 
             _ATLTRY
             {
-                m_Content.Add(pNetworkConfigContent);
+                AddContent(pNetworkConfigContent);
             }
             _ATLCATCH(e)
             {
@@ -223,7 +223,7 @@ public:
 
             _ATLTRY
             {
-                m_Content.Add(pFolderContent);
+                AddContent(pFolderContent);
             }
             _ATLCATCH(e)
             {
@@ -254,7 +254,7 @@ public:
 
             _ATLTRY
             {
-                m_Content.Add(pFolderContent);
+                AddContent(pFolderContent);
             }
             _ATLCATCH(e)
             {
@@ -285,7 +285,7 @@ public:
 
             _ATLTRY
             {
-                m_Content.Add(pMemoFolderContent);
+                AddContent(pMemoFolderContent);
             }
             _ATLCATCH(e)
             {
@@ -316,7 +316,7 @@ public:
 
             _ATLTRY
             {
-                m_Content.Add(pFolderContent);
+                AddContent(pFolderContent);
             }
             _ATLCATCH(e)
             {
@@ -347,7 +347,7 @@ public:
 
             _ATLTRY
             {
-                m_Content.Add(pFolderContent);
+                AddContent(pFolderContent);
             }
             _ATLCATCH(e)
             {
@@ -378,7 +378,7 @@ public:
 
             _ATLTRY
             {
-                m_Content.Add(pFolderContent);
+                AddContent(pFolderContent);
             }
             _ATLCATCH(e)
             {
@@ -409,7 +409,7 @@ public:
 
             _ATLTRY
             {
-                m_Content.Add(pFolderContent);
+                AddContent(pFolderContent);
             }
             _ATLCATCH(e)
             {
@@ -445,7 +445,7 @@ public:
 
                 _ATLTRY
                 {
-                    m_Content.Add(pGenericFileContent);
+                    AddContent(pGenericFileContent);
                 }
                 _ATLCATCH(e)
                 {
@@ -479,7 +479,7 @@ public:
 
                 _ATLTRY
                 {
-                    m_Content.Add(pImageContent);
+                    AddContent(pImageContent);
                 }
                 _ATLCATCH(e)
                 {
@@ -513,7 +513,7 @@ public:
 
                 _ATLTRY
                 {
-                    m_Content.Add(pMusicContent);
+                    AddContent(pMusicContent);
                 }
                 _ATLCATCH(e)
                 {
@@ -547,7 +547,7 @@ public:
 
                 _ATLTRY
                 {
-                    m_Content.Add(pVideoContent);
+                    AddContent(pVideoContent);
                 }
                 _ATLCATCH(e)
                 {
@@ -588,7 +588,7 @@ public:
 
                 _ATLTRY
                 {
-                    m_Content.Add(pContactContent);
+                    AddContent(pContactContent);
                 }
                 _ATLCATCH(e)
                 {
@@ -622,7 +622,7 @@ public:
 
                 _ATLTRY
                 {
-                    m_Content.Add(pMemoContent);
+                    AddContent(pMemoContent);
                 }
                 _ATLCATCH(e)
                 {
@@ -697,19 +697,31 @@ public:
 
         *ppElement = NULL;
 
-        for(DWORD Index = 0; Index < m_Content.GetCount(); Index++)
-        {
-            if(m_Content[Index]->ObjectID == pszObjectID)
-            {
-                *ppElement = m_Content[Index];
-                bFound = true;
-                break;
-            }
-        }
+        bFound = m_ContentMap.Lookup(pszObjectID, *ppElement);
 
         return bFound;
     }
 
+    /**
+     * Adds the content object to the list of content and to the ObjectID
+     * index used by GetContent.
+     * Throws a CAtlException on failure, in which case neither is updated.
+     */
+    void AddContent(_In_ FakeContent* pContent)
+    {
+        size_t Index = m_Content.Add(pContent);
+
+        _ATLTRY
+        {
+            m_ContentMap.SetAt(pContent->ObjectID, pContent);
+        }
+        _ATLCATCH(e)
+        {
+            m_Content.RemoveAt(Index);
+            AtlThrow(e);
+        }
+    }
+
     /**
      * Returns the index of the fake content corresponding to the
      * specified ObjectID.
@@ -818,10 +830,59 @@ public:
     }
 
     /**
-     * This fake device is an unrealistic example from a performance standpoint, since
-     * requesting some values is more costly than requesting all values.
-     * The reason for this is that is is easier for the underlying objects to simply return all the
-     * values, and for us to filter out only the ones we want here.
+     * Returns the complete property blob of the object.  The blob is built on
+     * first use and kept on the object until one of its properties, resources
+     * or its parent changes, so repeated (bulk) reads do not rebuild it.
+     * The returned store is shared: callers must not modify it.
+     */
+    HRESULT GetCachedValues(
+        _In_         LPCWSTR                 pszObjectID,
+        _COM_Outptr_ IPortableDeviceValues** ppValues)
+    {
+        HRESULT                 hr          = S_OK;
+        FakeContent*            pElement    = NULL;
+
+        if(ppValues == NULL)
+        {
+            hr = E_POINTER;
+            CHECK_HR(hr, "Cannot have NULL parameter");
+            return hr;
+        }
+
+        *ppValues = NULL;
+
+        if(GetContent(pszObjectID, &pElement))
+        {
+            if(pElement->CachedValues != NULL)
+            {
+                hr = pElement->CachedValues.CopyTo(ppValues);
+                CHECK_HR(hr, "Failed to return cached property values");
+            }
+            else
+            {
+                hr = GetAllValues(pszObjectID, ppValues);
+                CHECK_HR(hr, "Failed to get property values [%ws]", pszObjectID);
+
+                // Only complete property sets are kept, so a partial failure is retried
+                if(hr == S_OK)
+                {
+                    pElement->CachedValues = *ppValues;
+                }
+            }
+        }
+        else
+        {
+            hr = E_INVALIDARG;
+            CHECK_HR(hr, "Invalid ObjectID [%ws]", pszObjectID ? pszObjectID : L"NULL");
+        }
+
+        return hr;
+    }
+
+    /**
+     * Requesting some values filters the object's cached property blob (see
+     * GetCachedValues), so after the first request on an object it costs no more
+     * than requesting all values.
      * It is not expected that real devices function this way.
      */
     HRESULT GetValues(
@@ -855,10 +916,10 @@ public:
             CHECK_HR(hr, "Failed to CoCreate CLSID_PortableDevicePropVariantCollection");
         }
 
-        // Get ALL values (NOTE: This is inefficient)
+        // Get ALL values from the cached property blob
         if (SUCCEEDED(hr))
         {
-            hr = GetAllValues(pszObjectID, &pAllValues);
+            hr = GetCachedValues(pszObjectID, &pAllValues);
             CHECK_HR(hr, "Failed to get property values [%ws]", pszObjectID);
         }
 
@@ -913,6 +974,7 @@ public:
 
         if(GetContent(pszObjectID, &pElement))
         {
+            pElement->CachedValues.Release();
             hr = pElement->WriteValue(key, Value);
             CHECK_HR(hr, "Failed to write property value");
         }
@@ -971,6 +1033,7 @@ public:
                     FakeContent*    pElement    = NULL;
                     if(GetContent(pszObjectID, &pElement))
                     {
+                        pElement->CachedValues.Release();
                         hr = pElement->WriteValue(Key, pvValue);
                         CHECK_HR(hr, "Failed to write property value");
                     }
@@ -1149,6 +1212,7 @@ public:
 
         if(GetContent(pszObjectID, &pElement))
         {
+            pElement->CachedValues.Release();
             hr = pElement->WriteData(ResourceKey, dwStartByte, pBuffer, dwNumBytesToWrite, pdwNumBytesWritten);
             CHECK_HR(hr, "Failed to write resource data for %ws.%d", CComBSTR(ResourceKey.fmtid), ResourceKey.pid);
         }
@@ -1192,6 +1256,7 @@ public:
             {
                 // Delete this object
                 FakeContent* pContent = m_Content[Index - 1];
+                m_ContentMap.RemoveKey(pContent->ObjectID);
                 m_Content.RemoveAt(Index - 1);
                 delete pContent;
             }
@@ -1310,7 +1375,7 @@ public:
         _Outptr_result_nullonfailure_   LPWSTR*                 ppszObjectID)
     {
         HRESULT     hr              = S_OK;
-        DWORD       dwParentIndex   = 0;
+        FakeContent* pParent        = NULL;
         LPWSTR      pszObjectName   = NULL;
         LPWSTR      pszParentID     = NULL;
         GUID        guidContentType = WPD_CONTENT_TYPE_UNSPECIFIED;
@@ -1342,7 +1407,7 @@ public:
             CHECK_HR(hr, "Failed to get WPD_OBJECT_NAME");
         }
 
-        if (SUCCEEDED(hr) && !GetContentIndex(pszParentID, &dwParentIndex))
+        if (SUCCEEDED(hr) && !GetContent(pszParentID, &pParent))
         {
             hr = E_INVALIDARG;
             CHECK_HR(hr, "Invalid Parent ObjectID [%ws]", pszParentID);
@@ -1351,13 +1416,13 @@ public:
         // Check whether the parent can hold objects of this content type
         if (SUCCEEDED(hr))
         {
-            hr = IsValidContentType(guidContentType, m_Content[dwParentIndex]->RestrictToContentTypes);
+            hr = IsValidContentType(guidContentType, pParent->RestrictToContentTypes);
             CHECK_HR(hr, "Object named [%ws] could not be created,  because parent [%ws] does not support this content type", pszObjectName, pszParentID);
         }
 
         if (SUCCEEDED(hr))
         {
-            FakeContent* pContent;
+            FakeContent* pContent = NULL;
 
             // Create the object
             hr = CreateContentObject(pszObjectName, pszParentID, guidContentType, pObjectProperties, &pContent);
@@ -1366,7 +1431,21 @@ public:
             // Add it to the sample driver's internal list of content objects
             if (SUCCEEDED(hr))
             {
-                m_Content.Add(pContent);
+                _ATLTRY
+                {
+                    AddContent(pContent);
+                }
+                _ATLCATCH(e)
+                {
+                    hr = e;
+                    CHECK_HR(hr, "ATL Exception when adding new content object");
+                    delete pContent;
+                    pContent = NULL;
+                }
+            }
+
+            if (SUCCEEDED(hr))
+            {
                 *ppszObjectID = AtlAllocTaskWideString(pContent->ObjectID);
                 if(*ppszObjectID == NULL)
                 {
@@ -1387,7 +1466,14 @@ public:
     const CAtlStringW GetParentID(
         _In_    LPCWSTR pszObjectID)
     {
-        CAtlStringW strParent = L"";
+        CAtlStringW  strParent = L"";
+        FakeContent* pElement  = NULL;
+
+        // Try the ObjectID index first, and fall back to a case-insensitive search
+        if(GetContent(pszObjectID, &pElement))
+        {
+            return pElement->ParentID;
+        }
 
         for (size_t Index = 0; Index < m_Content.GetCount(); Index++)
         {
@@ -1630,6 +1716,7 @@ public:
                     {
                         if(pDestFolder->ContentType == WPD_CONTENT_TYPE_FOLDER)
                         {
+                            pSource->CachedValues.Release();
                             pSource->ParentID = pszDestinationID;
                         }
                         else
@@ -2290,6 +2377,7 @@ public:
 
         if (GetContent(pszObjectID, &pContent) == true)
         {
+            pContent->CachedValues.Release();
             hr = pContent->EnableResource(ResourceKey);
         }
         else
@@ -2379,6 +2467,8 @@ public:
             LPWSTR  wszOriginalFileName = NULL;
             LPWSTR  wszObjectName       = NULL;
 
+            pElement->CachedValues.Release();
+
             // Update selected properties; other properties will be discarded.
             hrTemp = pObjectProperties->GetStringValue(WPD_OBJECT_ORIGINAL_FILE_NAME, &wszOriginalFileName);
             if(hrTemp == S_OK)
@@ -2408,8 +2498,9 @@ public:
     }
 
 private:
-    CAtlArray<FakeContent*> m_Content;
-    DWORD                   m_dwLastObjectID;
+    CAtlArray<FakeContent*>                 m_Content;
+    CAtlMap<CAtlStringW, FakeContent*>      m_ContentMap;
+    DWORD                                   m_dwLastObjectID;
 };
 
 
@@ -1,7 +1,9 @@
 #include "stdafx.h"
 #include "WpdObjectPropertiesBulk.tmh"
 
-#define MAX_OBJECTS_TO_RETURN 20
+// Number of objects returned per bulk NEXT request.  Property blobs are cached per
+// object, so larger pages mainly save round trips.
+#define MAX_OBJECTS_TO_RETURN 200
 
 WpdObjectPropertiesBulk::WpdObjectPropertiesBulk()
 {
@@ -283,21 +285,23 @@ HRESULT WpdObjectPropertiesBulk::OnGetValuesByObjectListNext(
                 {
                     hr = m_pFakeDevice->GetValues(pv.pwszVal, pContext->Properties, &pValues);
                     CHECK_HR(hr, "Failed to get property values for [%ws]", pv.pwszVal);
+
+                    // Add the ObjectID to the returned results
+                    if (SUCCEEDED(hr))
+                    {
+                        hr = pValues->SetStringValue(WPD_OBJECT_ID, pv.pwszVal);
+                        CHECK_HR(hr, "Failed to set WPD_OBJECT_ID for %ws", pv.pwszVal);
+                    }
                 }
                 else
                 {
-                    hr = m_pFakeDevice->GetAllValues(pv.pwszVal, &pValues);
+                    // The cached property blob already holds WPD_OBJECT_ID, and is shared
+                    // with other requests so it is added to the results unmodified.
+                    hr = m_pFakeDevice->GetCachedValues(pv.pwszVal, &pValues);
                     CHECK_HR(hr, "Failed to get property values for [%ws]", pv.pwszVal);
                 }
             }
 
-            // Add the ObjectID to the returned results
-            if (SUCCEEDED(hr))
-            {
-                hr = pValues->SetStringValue(WPD_OBJECT_ID, pv.pwszVal);
-                CHECK_HR(hr, "Failed to set WPD_OBJECT_ID for %ws", pv.pwszVal);
-            }
-
             if (SUCCEEDED(hr))
             {
                 hr = pCollection->Add(pValues);
@@ -548,21 +552,23 @@ HRESULT WpdObjectPropertiesBulk::OnGetValuesByObjectFormatNext(
                 {
                     hr = m_pFakeDevice->GetValues(pv.pwszVal, pContext->Properties, &pValues);
                     CHECK_HR(hr, "Failed to get property values for [%ws]", pv.pwszVal);
+
+                    // Add the ObjectID to the returned results
+                    if (SUCCEEDED(hr))
+                    {
+                        hr = pValues->SetStringValue(WPD_OBJECT_ID, pv.pwszVal);
+                        CHECK_HR(hr, "Failed to set WPD_OBJECT_ID for %ws", pv.pwszVal);
+                    }
                 }
                 else
                 {
-                    hr = m_pFakeDevice->GetAllValues(pv.pwszVal, &pValues);
+                    // The cached property blob already holds WPD_OBJECT_ID, and is shared
+                    // with other requests so it is added to the results unmodified.
+                    hr = m_pFakeDevice->GetCachedValues(pv.pwszVal, &pValues);
                     CHECK_HR(hr, "Failed to get property values for [%ws]", pv.pwszVal);
                 }
             }
 
-            // Add the ObjectID to the returned results
-            if (SUCCEEDED(hr))
-            {
-                hr = pValues->SetStringValue(WPD_OBJECT_ID, pv.pwszVal);
-                CHECK_HR(hr, "Failed to set WPD_OBJECT_ID for %ws", pv.pwszVal);
-            }
-
             if (SUCCEEDED(hr))
             {
                 hr = pCollection->Add(pValues);